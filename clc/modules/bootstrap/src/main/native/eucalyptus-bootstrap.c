@@ -108,6 +108,8 @@ pid_t child_pid = 0;
 char *java_library(euca_opts *, java_home_t *);
 int java_init(euca_opts *, java_home_t *);
 int JVM_destroy(int);
+static int java_version(char *);
+static void java_warmup(euca_opts *);
 
 static void java_fail(void)
 {
@@ -128,6 +130,7 @@ static java_home_t *get_java_home(char *path)
     data->path = strdup(path);
     data->jvms = NULL;
     data->jnum = 0;
+    data->version = java_version(path);
     while (libjvm_paths[++x] != NULL) {
         __abort(NULL, ((k = snprintf(buf, 1024, libjvm_paths[x], path)) <= 0), "Error mangling jvm path");
         __debug("Attempting to locate VM library %s", buf);
@@ -406,6 +409,7 @@ static int child(euca_opts * args, java_home_t * data, uid_t uid, gid_t gid)
     __abort(4, set_keys_ownership(GETARG(args, home), uid, gid) != 0, "Setting ownership of keyfile failed.");
     __abort(4, linuxset_user_group(GETARG(args, user), uid, gid) != 0, "Setting the user failed.");
     __die_jni((r = (*env)->CallBooleanMethod(env, bootstrap.instance, bootstrap.load)) == 0, "Failed to load Eucalyptus.");
+    java_warmup(args);
     __die_jni((r = (*env)->CallBooleanMethod(env, bootstrap.instance, bootstrap.start)) == 0, "Failed to start Eucalyptus.");
     handle._hup = signal_set(SIGHUP, handler);
     handle._term = signal_set(SIGTERM, handler);
@@ -741,6 +745,188 @@ char *java_library_path(euca_opts * args)
     return jar_list;
 }
 
+/* Y, yes, true or 1 in the environment variable */
+static int env_flag(const char *name)
+{
+    char *value = getenv(name);
+    return (value != NULL && value[0] != '\0' && strchr("YyTt1", value[0]) != NULL);
+}
+
+/* the major Java version of a Java home, from its release file, or 0 if unknown */
+static int java_version(char *path)
+{
+    char buf[1024], *version = NULL;
+    int major = 0;
+    FILE *fp = NULL;
+    snprintf(buf, 1024, "%s/release", path);
+    if ((fp = fopen(buf, "r")) == NULL)
+        return 0;
+    while (fgets(buf, 1024, fp) != NULL) {
+        if (strncmp(buf, "JAVA_VERSION=\"", 14) != 0)
+            continue;
+        version = buf + 14;
+        /* 1.8.0_x up to Java 8, 11.0.x after */
+        if (strncmp(version, "1.", 2) == 0)
+            version += 2;
+        major = atoi(version);
+        break;
+    }
+    fclose(fp);
+    return major;
+}
+
+/* the newest of the JVM and of the Eucalyptus jars, which class data archived from them depends on */
+static time_t java_classpath_mtime(euca_opts * args, java_home_t * data)
+{
+    char lib_dir[256], jar[512];
+    time_t newest = 0;
+    struct stat st;
+    struct direct *dir_ent;
+    DIR *lib_dir_p = NULL;
+    if (stat(java_library(args, data), &st) == 0)
+        newest = st.st_mtime;
+    snprintf(lib_dir, 255, EUCALYPTUS_JAVA_LIB_DIR, GETARG(args, home));
+    if ((lib_dir_p = opendir(lib_dir)) == NULL)
+        return newest;
+    while ((dir_ent = readdir(lib_dir_p)) != 0) {
+        snprintf(jar, 511, "%s/%s", lib_dir, dir_ent->d_name);
+        if (strstr(dir_ent->d_name, ".jar") != NULL && stat(jar, &st) == 0 && st.st_mtime > newest)
+            newest = st.st_mtime;
+    }
+    closedir(lib_dir_p);
+    return newest;
+}
+
+/*
+ * Heap and GC options of the deployment preset in CLOUD_JVM_PRESET, with the heap size in
+ * CLOUD_JVM_HEAP if set, then with CLOUD_JVM_CDS the class data sharing archive, and with
+ * CLOUD_JVM_WARMUP the list of classes to warm up with. An archive or a list that is missing,
+ * or older than the JVM or a jar, is written again when the JVM exits.
+ */
+static int java_tuning_options(euca_opts * args, java_home_t * data, JavaVMOption * opt, int x)
+{
+    char archive[256], classlist[256];
+    char *preset_name = getenv("CLOUD_JVM_PRESET"), *heap = getenv("CLOUD_JVM_HEAP");
+    jvm_preset_t *preset = &jvm_presets[0];
+    time_t classpath_mtime = 0;
+    struct stat st;
+    int i, n;
+    if (preset_name != NULL && strlen(preset_name) > 0) {
+        for (i = 0; jvm_presets[i].name != NULL && strcmp(jvm_presets[i].name, preset_name) != 0; i++) ;
+        if (jvm_presets[i].name != NULL)
+            preset = &jvm_presets[i];
+        else
+            __error("Unknown JVM preset %s, using %s", preset_name, preset->name);
+    }
+    if (heap != NULL && strlen(heap) > 0) {
+        n = strspn(heap, "0123456789");
+        if (n == 0 || (heap[n] != '\0' && (strchr("kKmMgG", heap[n]) == NULL || heap[n + 1] != '\0'))) {
+            __error("Invalid JVM heap size %s, using %s", heap, preset->heap);
+            heap = preset->heap;
+        }
+    } else {
+        heap = preset->heap;
+    }
+    __debug("Using JVM preset %s with a %s heap on Java %d", preset->name, heap, data->version);
+    JVM_ARG(opt[++x], "-Xmx%s", heap);
+    if (preset->fixed_heap)
+        JVM_ARG(opt[++x], "-Xms%s", heap);
+    /* the permanent generation is gone as of Java 8, and CMS as of Java 14 */
+    if (data->version < 9)
+        JVM_ARG(opt[++x], "-XX:MaxPermSize=256m");
+    if (preset->opts[0] == NULL && data->version < 14)
+        JVM_ARG(opt[++x], "-XX:+UseConcMarkSweepGC");
+    for (i = 0; preset->opts[i] != NULL; i++)
+        JVM_ARG(opt[++x], "%s", preset->opts[i]);
+
+    if (env_flag("CLOUD_JVM_CDS") || env_flag("CLOUD_JVM_WARMUP"))
+        classpath_mtime = java_classpath_mtime(args, data);
+    snprintf(archive, 255, EUCALYPTUS_CDS_ARCHIVE, GETARG(args, home));
+    if (env_flag("CLOUD_JVM_CDS")) {
+        if (data->version < 13) {
+            __error("Class data sharing of Eucalyptus classes needs Java 13 or later, found %d", data->version);
+        } else if (stat(archive, &st) == 0 && st.st_mtime >= classpath_mtime) {
+            JVM_ARG(opt[++x], "-XX:SharedArchiveFile=%s", archive);
+            JVM_ARG(opt[++x], "-Xshare:auto");
+        } else {
+            __debug("Writing class data sharing archive %s on exit", archive);
+            unlink(archive);
+            JVM_ARG(opt[++x], "-XX:ArchiveClassesAtExit=%s", archive);
+        }
+    }
+    snprintf(classlist, 255, EUCALYPTUS_WARMUP_LIST, GETARG(args, home));
+    if (env_flag("CLOUD_JVM_WARMUP") && data->version >= 11 && (stat(classlist, &st) != 0 || st.st_mtime < classpath_mtime)) {
+        __debug("Writing warm-up class list %s", classlist);
+        unlink(classlist);
+        JVM_ARG(opt[++x], "-XX:DumpLoadedClassList=%s", classlist);
+    }
+    return x;
+}
+
+/*
+ * With CLOUD_JVM_WARMUP, loads and links the Eucalyptus classes that the previous run loaded,
+ * without initializing them, so services do not pay for it once they are ENABLED.
+ */
+static void java_warmup(euca_opts * args)
+{
+    char classlist[256], line[1024], *c = NULL;
+    int loaded = 0, failed = 0;
+    FILE *fp = NULL;
+    jclass class_class, loader_class;
+    jmethodID for_name, system_loader;
+    jobject loader, clazz;
+    jstring name;
+    struct timeval start, stop;
+    if (!env_flag("CLOUD_JVM_WARMUP"))
+        return;
+    snprintf(classlist, 255, EUCALYPTUS_WARMUP_LIST, GETARG(args, home));
+    if ((fp = fopen(classlist, "r")) == NULL) {
+        __debug("No warm-up class list %s yet", classlist);
+        return;
+    }
+    __die(((class_class = (*env)->FindClass(env, "java/lang/Class")) == NULL), "Cannot find java/lang/Class class");
+    __die(((for_name =
+            (*env)->GetStaticMethodID(env, class_class, "forName", "(Ljava/lang/String;ZLjava/lang/ClassLoader;)Ljava/lang/Class;")) == NULL),
+          "Cannot find the Class.forName entry point");
+    __die(((loader_class = (*env)->FindClass(env, "java/lang/ClassLoader")) == NULL), "Cannot find java/lang/ClassLoader class");
+    __die(((system_loader = (*env)->GetStaticMethodID(env, loader_class, "getSystemClassLoader", "()Ljava/lang/ClassLoader;")) == NULL),
+          "Cannot find the ClassLoader.getSystemClassLoader entry point");
+    __die_jni(((loader = (*env)->CallStaticObjectMethod(env, loader_class, system_loader)) == NULL), "Cannot get the system class loader");
+    gettimeofday(&start, NULL);
+    while (fgets(line, 1024, fp) != NULL) {
+        /* a class per line, followed by attributes on recent releases */
+        line[strcspn(line, " \t\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#' || line[0] == '@' || strstr(line, "$$Lambda") != NULL)
+            continue;
+        /* the JVM loads what it needs of the JDK early on anyway */
+        if (strncmp(line, "java/", 5) == 0 || strncmp(line, "javax/", 6) == 0 || strncmp(line, "jdk/", 4) == 0 || strncmp(line, "sun/", 4) == 0
+            || strncmp(line, "com/sun/", 8) == 0)
+            continue;
+        for (c = line; *c != '\0'; c++)
+            if (*c == '/')
+                *c = '.';
+        if ((name = (*env)->NewStringUTF(env, line)) == NULL) {
+            (*env)->ExceptionClear(env);
+            break;
+        }
+        clazz = (*env)->CallStaticObjectMethod(env, class_class, for_name, name, JNI_FALSE, loader);
+        if ((*env)->ExceptionCheck(env)) {
+            (*env)->ExceptionClear(env);
+            failed++;
+        } else {
+            loaded++;
+        }
+        if (clazz != NULL)
+            (*env)->DeleteLocalRef(env, clazz);
+        (*env)->DeleteLocalRef(env, name);
+    }
+    fclose(fp);
+    (*env)->DeleteLocalRef(env, loader);
+    gettimeofday(&stop, NULL);
+    __debug("Warmed up %d classes in %ld ms, %d could not be loaded", loaded,
+            (long)((stop.tv_sec - start.tv_sec) * 1000 + (stop.tv_usec - start.tv_usec) / 1000), failed);
+}
+
 int java_init(euca_opts * args, java_home_t * data)
 {
     jint(*hotspot_main) (JavaVM **, JNIEnv **, JavaVMInitArgs *);
@@ -771,6 +957,7 @@ int java_init(euca_opts * args, java_home_t * data)
     i = -1;
     while (jvm_default_opts[++i] != NULL)
         JVM_ARG(opt[++x], jvm_default_opts[i], GETARG(args, home));
+    x = java_tuning_options(args, data, opt, x);
     if (args->exhaustive_flag) {
         JVM_ARG(opt[++x], "-Deuca.log.exhaustive=TRACE");
         JVM_ARG(opt[++x], "-Deuca.log.exhaustive.db=TRACE");
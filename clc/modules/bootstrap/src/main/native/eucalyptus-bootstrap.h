@@ -97,6 +97,7 @@ typedef struct {
     char *path;
     jvm_info_t **jvms;
     int jnum;
+    int version;                /* major Java version, 0 if unknown */
 } java_home_t;
 #define GETARG(a,x) (a->x##_arg)
 static int debug = 0;
@@ -153,6 +154,8 @@ static int debug = 0;
 #define EUCALYPTUS_SCRIPT_DIR      EUCALYPTUS_ETC_DIR "/scripts"
 #define EUCALYPTUS_JAVA_LIB_DIR    EUCALYPTUS_DATA_DIR
 #define EUCALYPTUS_CLASSCACHE_DIR  EUCALYPTUS_RUN_DIR "/classcache"
+#define EUCALYPTUS_CDS_ARCHIVE     EUCALYPTUS_STATE_DIR "/eucalyptus-cloud.jsa"
+#define EUCALYPTUS_WARMUP_LIST     EUCALYPTUS_STATE_DIR "/eucalyptus-cloud.classlist"
 #define java_load_bootstrapper euca_load_bootstrapper
 
 void euca_load_bootstrapper(void);
@@ -193,9 +196,6 @@ typedef struct {
 } while(0)
 static char *jvm_default_opts[] = {
     "-Xbootclasspath/p:%1$s" EUCALYPTUS_DATA_DIR "/openjdk-crypto.jar",
-    "-Xmx2g",
-    "-XX:MaxPermSize=256m",
-    "-XX:+UseConcMarkSweepGC",
     "-Djava.net.preferIPv4Stack=true",
     "-Djava.security.policy=" EUCALYPTUS_ETC_DIR "/security.policy",
     "-Djava.library.path=" EUCALYPTUS_LIB_DIR,
@@ -216,11 +216,28 @@ static char *jvm_default_opts[] = {
     NULL,
 };
 
+/* heap and GC settings for the size of a deployment, chosen with CLOUD_JVM_PRESET */
+#define JVM_PRESET_MAX_OPTS 8
+typedef struct {
+    char *name;
+    char *heap;                 /* -Xmx, overridden by CLOUD_JVM_HEAP */
+    int fixed_heap;             /* also start with the whole heap (-Xms) */
+    char *opts[JVM_PRESET_MAX_OPTS];
+} jvm_preset_t;
+static jvm_preset_t jvm_presets[] = {
+    {"default", "2g", 0, {NULL}},
+    {"large", "8g", 1, {"-XX:+UseG1GC", "-XX:MaxGCPauseMillis=200", "-XX:+ParallelRefProcEnabled", "-XX:InitiatingHeapOccupancyPercent=45", NULL}},
+    {"xlarge", "16g", 1, {"-XX:+UseG1GC", "-XX:MaxGCPauseMillis=200", "-XX:+ParallelRefProcEnabled", "-XX:InitiatingHeapOccupancyPercent=45",
+                          "-XX:+AlwaysPreTouch", NULL}},
+    {NULL, NULL, 0, {NULL}},
+};
+
 static char *libjvm_paths[] = {
     "%1$s/jre/lib/amd64/server/libjvm.so",
     "%1$s/lib/amd64/server/libjvm.so",
     "%1$s/jre/lib/i386/server/libjvm.so",
     "%1$s/lib/i386/server/libjvm.so",
+    "%1$s/lib/server/libjvm.so",
     NULL,
 };
 
@@ -0,0 +1,907 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/CCsim.c
+//! Cluster-scale load driver for a CC running against simulated NCs
+//!
+//! The CC under test is built with 'make fake' and deployed with 'make fakedeploy', so that
+//! all of its NC calls go to node/client-marshal-fake.c. Every name in NODES then becomes a
+//! simulated node whose latency, failure rate and initial instance count are set by the
+//! FAKE_NC_* variables of eucalyptus.conf ('CCsim -c <nodes>' prints a suitable block).
+//!
+//! CCsim then issues RunInstances, DescribeInstances, TerminateInstances and
+//! BroadcastNetworkInfo requests to the CC at a target rate from a number of threads and
+//! reports, as key=value lines:
+//!     \li the throughput, failure count and latency percentiles of every operation;
+//!     \li the cycle time of refresh_instances(), sampled from the CC message statistics;
+//!     \li the size and resident size of the CC shared memory segments.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <euca_axis.h>
+#include <euca_auth.h>
+#include <euca_file.h>
+#include <data.h>
+#include <sensor.h>
+#include <message_stats.h>
+
+#include <vnetwork.h>
+#include "handlers.h"
+#include "cc-client-marshal.h"
+#include "axis2_stub_EucalyptusCC.h"
+#include <adb-helpers.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define SIM_MAX_THREADS                          256    //!< Maximum number of request threads
+#define SIM_MAX_POOL                           MAXINSTANCES_PER_CC  //!< Maximum number of launched instances tracked for termination
+#define SIM_REFRESH_MESSAGE                "refresh_instances"  //!< Message stat the CC monitor thread keeps the cycle time in
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Operations issued to the CC, in the order of the -m weights
+enum {
+    SIM_RUN,
+    SIM_DESCRIBE,
+    SIM_TERMINATE,
+    SIM_NETWORK,
+    SIM_OPS,
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! State of one request thread
+typedef struct simWorker_t {
+    pthread_t thread;                  //!< the thread
+    int index;                         //!< index of the thread, 0 to threads - 1
+    unsigned int seed;                 //!< rand_r() state
+    axutil_env_t *env;                 //!< AXIS2 environment of this thread
+    axis2_stub_t *stub;                //!< CC stub of this thread
+} simWorker;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#ifndef NO_COMP
+const char *euca_this_component_name = "cc";
+const char *euca_client_component_name = "clc";
+#endif /* ! NO_COMP */
+
+ncMetadata mymeta = { 0 };
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static const char *sim_op_names[SIM_OPS] = { "RunInstances", "DescribeInstances", "TerminateInstances", "BroadcastNetworkInfo" };
+
+//! CC shared memory segments, see init_thread() in handlers.c
+static const char *sim_segments[] = {
+    "eucalyptusCCConfig",
+    "eucalyptusCCInstanceCache",
+    "eucalyptusCCResourceCache",
+    "eucalyptusCCResourceCacheStage",
+    "eucalyptusCCSensorResourceCache",
+    "eucalyptusCCVNETConfig",
+    "eucalyptusCCglobalNetworkInfo",
+    "eucalyptusCCmessageStats",
+    "eucalyptusCCtraceRing",
+    NULL,
+};
+
+//! @{
+//! @name Settings, from the command line
+static int sim_threads = 4;            //!< number of request threads
+static double sim_rate = 10.0;         //!< target request rate of all threads together, per second
+static int sim_duration = 60;          //!< length of the run, in seconds
+static int sim_weights[SIM_OPS] = { 1, 6, 1, 0 };   //!< operation mix
+static int sim_weights_total = 8;      //!< sum of sim_weights[]
+static int sim_batch = 1;              //!< instances per RunInstances request
+static int sim_vlan = 10;              //!< VLAN the instances are launched in
+static char *sim_network_info = NULL;  //!< base64 encoded global network information, for BroadcastNetworkInfo
+//! @}
+
+//! @{
+//! @name Shared state of the request threads
+static volatile int sim_running = 1;   //!< cleared when the run is over
+static message_stats_state sim_stats;  //!< latencies of the requests, by operation
+static pthread_mutex_t sim_pool_lock = PTHREAD_MUTEX_INITIALIZER;   //!< protects sim_pool[] and sim_pool_len
+static char sim_pool[SIM_MAX_POOL][CHAR_BUFFER_SIZE];  //!< instances launched and not yet terminated
+static int sim_pool_len = 0;           //!< number of entries in sim_pool[]
+static long long sim_instances_seen = 0;    //!< sum of the instance counts returned by DescribeInstances
+//! @}
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void usage(void);
+static int print_node_config(int nodes, int latency_ms, int failure_rate, int instances);
+static void pool_add(const char *instanceId);
+static int pool_take(simWorker * w, char *instanceId, int len);
+static int sim_run_instances(simWorker * w);
+static int sim_describe_instances(simWorker * w);
+static int sim_terminate_instances(simWorker * w);
+static int sim_broadcast_network_info(simWorker * w);
+static void *sim_worker(void *arg);
+static void *map_state_file(const char *name, size_t * size);
+static void sample_refresh_stat(message_stat * acc, message_stat * last);
+static void print_stat(const char *prefix, const message_stat * stat, double seconds);
+static void print_shared_memory(void);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Prints the usage of the application
+//!
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: CCsim <host:port> [-t threads] [-r requests/s] [-d seconds] [-m run:describe:terminate:network]\n"
+            "                          [-b instances/run] [-v vlan] [-n networkInfo.xml] [-e]\n"
+            "       CCsim -c <nodes> [-l latency_ms] [-f failure_percent] [-i instances/node]\n"
+            "\n"
+            "  the first form drives the CC at <host:port>, which must be built with 'make fake',\n"
+            "  -e starts and enables it first; the second form prints the eucalyptus.conf settings\n"
+            "  of a cluster of simulated nodes\n");
+}
+
+//!
+//! Prints the eucalyptus.conf settings of a cluster of simulated nodes. The nodes are named
+//! by loopback addresses so that the CC does not need to resolve them.
+//!
+//! @param[in] nodes number of nodes, up to MAXNODES
+//! @param[in] latency_ms mean time spent by each NC call
+//! @param[in] failure_rate percentage of NC calls that fail
+//! @param[in] instances number of instances running on each node at startup
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the node count is out of range
+//!
+static int print_node_config(int nodes, int latency_ms, int failure_rate, int instances)
+{
+    int i = 0;
+
+    if ((nodes < 1) || (nodes > MAXNODES)) {
+        fprintf(stderr, "node count must be between 1 and %d\n", MAXNODES);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    printf("NODES=\"");
+    for (i = 0; i < nodes; i++) {
+        printf("%s127.0.%d.%d", ((i == 0) ? "" : " "), ((i + 1) / 254), (((i + 1) % 254) + 1));
+    }
+    printf("\"\n");
+    printf("FAKE_NC_LATENCY_MS=\"%d\"\n", latency_ms);
+    printf("FAKE_NC_FAILURE_RATE=\"%d\"\n", failure_rate);
+    printf("FAKE_NC_INSTANCES=\"%d\"\n", instances);
+    return (EUCA_OK);
+}
+
+//!
+//! Remembers an instance launched by the simulation, for a later TerminateInstances
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+static void pool_add(const char *instanceId)
+{
+    pthread_mutex_lock(&sim_pool_lock);
+    if (sim_pool_len < SIM_MAX_POOL) {
+        euca_strncpy(sim_pool[sim_pool_len++], instanceId, CHAR_BUFFER_SIZE);
+    }
+    pthread_mutex_unlock(&sim_pool_lock);
+}
+
+//!
+//! Removes a random instance from the pool of launched instances
+//!
+//! @param[in]  w the calling thread
+//! @param[out] instanceId buffer receiving the instance identifier
+//! @param[in]  len size of the instanceId buffer
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if the pool is empty
+//!
+static int pool_take(simWorker * w, char *instanceId, int len)
+{
+    int i = 0;
+    int ret = EUCA_NOT_FOUND_ERROR;
+
+    pthread_mutex_lock(&sim_pool_lock);
+    if (sim_pool_len > 0) {
+        i = rand_r(&(w->seed)) % sim_pool_len;
+        euca_strncpy(instanceId, sim_pool[i], len);
+        euca_strncpy(sim_pool[i], sim_pool[--sim_pool_len], CHAR_BUFFER_SIZE);
+        ret = EUCA_OK;
+    }
+    pthread_mutex_unlock(&sim_pool_lock);
+    return (ret);
+}
+
+//!
+//! Launches sim_batch instances and adds the ones the CC scheduled to the pool
+//!
+//! @param[in] w the calling thread
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int sim_run_instances(simWorker * w)
+{
+    int i = 0;
+    int ret = EUCA_ERROR;
+    char id[CHAR_BUFFER_SIZE] = "";
+    char mac[CHAR_BUFFER_SIZE] = "";
+    axutil_env_t *env = w->env;
+    adb_ccInstanceType_t *it = NULL;
+    adb_RunInstances_t *riIn = NULL;
+    adb_runInstancesType_t *rit = NULL;
+    adb_RunInstancesResponse_t *riOut = NULL;
+    adb_runInstancesResponseType_t *rirt = NULL;
+    virtualMachine params = { 64, 1, 1, "m1.small" };
+
+    rit = adb_runInstancesType_create(env);
+    EUCA_MESSAGE_MARSHAL(runInstancesType, rit, (&mymeta));
+    adb_runInstancesType_set_imageId(rit, env, "emi-00000001");
+    adb_runInstancesType_set_imageURL(rit, env, "http://localhost:8773/sim/machine");
+    adb_runInstancesType_set_kernelId(rit, env, "eki-00000001");
+    adb_runInstancesType_set_kernelURL(rit, env, "http://localhost:8773/sim/kernel");
+    adb_runInstancesType_set_ramdiskId(rit, env, "eri-00000001");
+    adb_runInstancesType_set_ramdiskURL(rit, env, "http://localhost:8773/sim/ramdisk");
+    adb_runInstancesType_set_minCount(rit, env, sim_batch);
+    adb_runInstancesType_set_maxCount(rit, env, sim_batch);
+    adb_runInstancesType_set_ownerId(rit, env, "sim");
+    adb_runInstancesType_set_accountId(rit, env, "sim");
+    adb_runInstancesType_set_platform(rit, env, "linux");
+    adb_runInstancesType_set_launchIndex(rit, env, "0");
+    adb_runInstancesType_set_keyName(rit, env, "");
+    adb_runInstancesType_set_userData(rit, env, "");
+    adb_runInstancesType_add_netNames(rit, env, "default");
+    adb_runInstancesType_set_instanceType(rit, env, copy_vm_type_to_adb(env, &params));
+    adb_runInstancesType_set_vlan(rit, env, sim_vlan);
+
+    for (i = 0; i < sim_batch; i++) {
+        snprintf(id, sizeof(id), "i-%08x", rand_r(&(w->seed)));
+        snprintf(mac, sizeof(mac), "d0:0d:%02x:%02x:%02x:%02x", (rand_r(&(w->seed)) & 0xFF), (rand_r(&(w->seed)) & 0xFF), (rand_r(&(w->seed)) & 0xFF),
+                 (rand_r(&(w->seed)) & 0xFF));
+        adb_runInstancesType_add_instanceIds(rit, env, id);
+        adb_runInstancesType_add_macAddresses(rit, env, mac);
+        adb_runInstancesType_add_uuids(rit, env, id);
+    }
+    snprintf(id, sizeof(id), "r-%08x", rand_r(&(w->seed)));
+    adb_runInstancesType_set_reservationId(rit, env, id);
+
+    riIn = adb_RunInstances_create(env);
+    adb_RunInstances_set_RunInstances(riIn, env, rit);
+    if ((riOut = axis2_stub_op_EucalyptusCC_RunInstances(w->stub, env, riIn)) != NULL) {
+        rirt = adb_RunInstancesResponse_get_RunInstancesResponse(riOut, env);
+        if (adb_runInstancesResponseType_get_return(rirt, env) == AXIS2_TRUE) {
+            for (i = 0; i < adb_runInstancesResponseType_sizeof_instances(rirt, env); i++) {
+                it = adb_runInstancesResponseType_get_instances_at(rirt, env, i);
+                pool_add(adb_ccInstanceType_get_instanceId(it, env));
+            }
+            ret = EUCA_OK;
+        }
+        adb_RunInstancesResponse_free(riOut, env);
+    }
+    return (ret);
+}
+
+//!
+//! Describes all instances of the CC
+//!
+//! @param[in] w the calling thread
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int sim_describe_instances(simWorker * w)
+{
+    int ret = EUCA_ERROR;
+    axutil_env_t *env = w->env;
+    adb_DescribeInstances_t *diIn = NULL;
+    adb_describeInstancesType_t *dit = NULL;
+    adb_DescribeInstancesResponse_t *diOut = NULL;
+    adb_describeInstancesResponseType_t *dirt = NULL;
+
+    dit = adb_describeInstancesType_create(env);
+    EUCA_MESSAGE_MARSHAL(describeInstancesType, dit, (&mymeta));
+    diIn = adb_DescribeInstances_create(env);
+    adb_DescribeInstances_set_DescribeInstances(diIn, env, dit);
+    if ((diOut = axis2_stub_op_EucalyptusCC_DescribeInstances(w->stub, env, diIn)) != NULL) {
+        dirt = adb_DescribeInstancesResponse_get_DescribeInstancesResponse(diOut, env);
+        if (adb_describeInstancesResponseType_get_return(dirt, env) == AXIS2_TRUE) {
+            __sync_fetch_and_add(&sim_instances_seen, adb_describeInstancesResponseType_sizeof_instances(dirt, env));
+            ret = EUCA_OK;
+        }
+        adb_DescribeInstancesResponse_free(diOut, env);
+    }
+    return (ret);
+}
+
+//!
+//! Terminates one of the instances launched by the simulation
+//!
+//! @param[in] w the calling thread
+//!
+//! @return EUCA_OK on success, EUCA_ERROR on failure or EUCA_NOT_FOUND_ERROR if there was nothing to terminate
+//!
+static int sim_terminate_instances(simWorker * w)
+{
+    int ret = EUCA_ERROR;
+    char id[CHAR_BUFFER_SIZE] = "";
+    axutil_env_t *env = w->env;
+    adb_TerminateInstances_t *tiIn = NULL;
+    adb_terminateInstancesType_t *tit = NULL;
+    adb_TerminateInstancesResponse_t *tiOut = NULL;
+    adb_terminateInstancesResponseType_t *tirt = NULL;
+
+    if (pool_take(w, id, sizeof(id)) != EUCA_OK)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    tit = adb_terminateInstancesType_create(env);
+    EUCA_MESSAGE_MARSHAL(terminateInstancesType, tit, (&mymeta));
+    adb_terminateInstancesType_add_instanceIds(tit, env, id);
+    tiIn = adb_TerminateInstances_create(env);
+    adb_TerminateInstances_set_TerminateInstances(tiIn, env, tit);
+    if ((tiOut = axis2_stub_op_EucalyptusCC_TerminateInstances(w->stub, env, tiIn)) != NULL) {
+        tirt = adb_TerminateInstancesResponse_get_TerminateInstancesResponse(tiOut, env);
+        if (adb_terminateInstancesResponseType_get_return(tirt, env) == AXIS2_TRUE)
+            ret = EUCA_OK;
+        adb_TerminateInstancesResponse_free(tiOut, env);
+    }
+    return (ret);
+}
+
+//!
+//! Sends the global network information given with -n to the CC
+//!
+//! @param[in] w the calling thread
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int sim_broadcast_network_info(simWorker * w)
+{
+    int ret = EUCA_ERROR;
+    axutil_env_t *env = w->env;
+    adb_BroadcastNetworkInfo_t *input = NULL;
+    adb_broadcastNetworkInfoType_t *sn = NULL;
+    adb_BroadcastNetworkInfoResponse_t *output = NULL;
+    adb_broadcastNetworkInfoResponseType_t *snrt = NULL;
+
+    sn = adb_broadcastNetworkInfoType_create(env);
+    EUCA_MESSAGE_MARSHAL(broadcastNetworkInfoType, sn, (&mymeta));
+    adb_broadcastNetworkInfoType_set_networkInfo(sn, env, sim_network_info);
+    input = adb_BroadcastNetworkInfo_create(env);
+    adb_BroadcastNetworkInfo_set_BroadcastNetworkInfo(input, env, sn);
+    if ((output = axis2_stub_op_EucalyptusCC_BroadcastNetworkInfo(w->stub, env, input)) != NULL) {
+        snrt = adb_BroadcastNetworkInfoResponse_get_BroadcastNetworkInfoResponse(output, env);
+        if (adb_broadcastNetworkInfoResponseType_get_return(snrt, env) == AXIS2_TRUE)
+            ret = EUCA_OK;
+        adb_BroadcastNetworkInfoResponse_free(output, env);
+    }
+    return (ret);
+}
+
+//!
+//! Request thread. Issues requests at sim_rate / sim_threads per second, picking each
+//! operation at random according to sim_weights[], and times them into sim_stats.
+//!
+//! @param[in] arg the simWorker of this thread
+//!
+//! @return Always NULL
+//!
+static void *sim_worker(void *arg)
+{
+    int op = 0;
+    int rc = 0;
+    int pick = 0;
+    long long start_ms = 0;
+    double next_ms = 0.0;
+    double period_ms = (1000.0 * sim_threads) / sim_rate;
+    simWorker *w = (simWorker *) arg;
+    struct timespec ts = { 0 };
+
+    // spread the threads over one period so that they do not fire in lockstep
+    next_ms = time_ms() + (period_ms * w->index) / sim_threads;
+    while (sim_running) {
+        if ((start_ms = time_ms()) < next_ms) {
+            ts.tv_sec = (long)(next_ms - start_ms) / 1000;
+            ts.tv_nsec = ((long)(next_ms - start_ms) % 1000) * 1000000;
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        next_ms += period_ms;
+
+        pick = rand_r(&(w->seed)) % sim_weights_total;
+        for (op = 0; (op < (SIM_OPS - 1)) && (pick >= sim_weights[op]); op++)
+            pick -= sim_weights[op];
+
+        start_ms = time_ms();
+        switch (op) {
+        case SIM_RUN:
+            rc = sim_run_instances(w);
+            break;
+        case SIM_DESCRIBE:
+            rc = sim_describe_instances(w);
+            break;
+        case SIM_TERMINATE:
+            // nothing launched yet, launch instead so that the request rate holds
+            if ((rc = sim_terminate_instances(w)) == EUCA_NOT_FOUND_ERROR) {
+                op = SIM_RUN;
+                start_ms = time_ms();
+                rc = sim_run_instances(w);
+            }
+            break;
+        case SIM_NETWORK:
+            rc = sim_broadcast_network_info(w);
+            break;
+        }
+        update_message_stats(&sim_stats, sim_op_names[op], (long)(time_ms() - start_ms), (rc != EUCA_OK));
+    }
+    return (NULL);
+}
+
+//!
+//! Maps one of the CC shared memory segments read-only
+//!
+//! @param[in]  name name of the segment file under the CC state directory
+//! @param[out] size size of the segment
+//!
+//! @return a pointer to the mapping or NULL if the segment does not exist
+//!
+static void *map_state_file(const char *name, size_t * size)
+{
+    int fd = -1;
+    char *home = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    void *buf = NULL;
+    struct stat mystat = { 0 };
+
+    if ((home = getenv(EUCALYPTUS_ENV_VAR_NAME)) == NULL)
+        home = "";
+    snprintf(path, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/CC/%s", home, name);
+
+    *size = 0;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (NULL);
+    if ((fstat(fd, &mystat) == 0) && (mystat.st_size > 0)) {
+        if ((buf = mmap(NULL, mystat.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+            buf = NULL;
+        } else {
+            *size = mystat.st_size;
+        }
+    }
+    close(fd);
+    return (buf);
+}
+
+//!
+//! Adds the refresh_instances() cycles the CC recorded since the last sample to acc. The
+//! message sensor of the CC resets its counters at every interval, which shows up here as
+//! a count going backwards: the cycles counted then are all new.
+//!
+//! @param[in,out] acc cycles seen so far
+//! @param[in,out] last the CC counters at the previous sample
+//!
+static void sample_refresh_stat(message_stat * acc, message_stat * last)
+{
+    int i = 0;
+    int reset = 0;
+    size_t size = 0;
+    message_stat current = { 0 };
+    message_stats_state *state = NULL;
+
+    if ((state = map_state_file("eucalyptusCCmessageStats", &size)) == NULL)
+        return;
+
+    if (size >= sizeof(message_stats_state)) {
+        for (i = 0; i < MSG_STATS_MAX_MESSAGES; i++) {
+            if ((state->messages[i].used == 2) && !strcmp(state->messages[i].name, SIM_REFRESH_MESSAGE)) {
+                memcpy(&current, &(state->messages[i]), sizeof(message_stat));
+                break;
+            }
+        }
+    }
+    munmap(state, size);
+
+    reset = (current.count < last->count);
+    acc->count += current.count - (reset ? 0 : last->count);
+    acc->ok_count += current.ok_count - (reset ? 0 : last->ok_count);
+    acc->fail_count += current.fail_count - (reset ? 0 : last->fail_count);
+    acc->total_ms += current.total_ms - (reset ? 0 : last->total_ms);
+    acc->max_ms = MAX(acc->max_ms, current.max_ms);
+    for (i = 0; i < MSG_HIST_BUCKETS; i++) {
+        acc->hist[i] += current.hist[i] - (reset ? 0 : last->hist[i]);
+    }
+    memcpy(last, &current, sizeof(message_stat));
+}
+
+//!
+//! Prints the count, throughput and latency distribution of a message stat
+//!
+//! @param[in] prefix key prefix
+//! @param[in] stat the message stat to print
+//! @param[in] seconds length of the run, for the throughput
+//!
+static void print_stat(const char *prefix, const message_stat * stat, double seconds)
+{
+    printf("%s.count=%lld\n", prefix, stat->count);
+    printf("%s.failures=%lld\n", prefix, stat->fail_count);
+    printf("%s.throughput=%.2f\n", prefix, ((seconds > 0) ? (stat->count / seconds) : 0.0));
+    printf("%s.mean_ms=%.1f\n", prefix, ((stat->count > 0) ? ((double)stat->total_ms / stat->count) : 0.0));
+    printf("%s.p50_ms=%lld\n", prefix, get_message_percentile(stat, 0.50));
+    printf("%s.p95_ms=%lld\n", prefix, get_message_percentile(stat, 0.95));
+    printf("%s.p99_ms=%lld\n", prefix, get_message_percentile(stat, 0.99));
+    printf("%s.p999_ms=%lld\n", prefix, get_message_percentile(stat, 0.999));
+    printf("%s.max_ms=%lld\n", prefix, stat->max_ms);
+}
+
+//!
+//! Prints the size and the resident size of the CC shared memory segments, along with
+//! the number of instances and resources in the CC caches
+//!
+static void print_shared_memory(void)
+{
+    int i = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t j = 0;
+    size_t size = 0;
+    size_t pages = 0;
+    size_t resident = 0;
+    size_t total = 0;
+    size_t total_resident = 0;
+    void *buf = NULL;
+    unsigned char *vec = NULL;
+
+    for (i = 0; sim_segments[i]; i++) {
+        if ((buf = map_state_file(sim_segments[i], &size)) == NULL)
+            continue;
+
+        pages = (size + page - 1) / page;
+        resident = 0;
+        if (((vec = EUCA_ZALLOC(pages, sizeof(unsigned char))) != NULL) && (mincore(buf, size, vec) == 0)) {
+            for (j = 0; j < pages; j++)
+                resident += (vec[j] & 1);
+        }
+        EUCA_FREE(vec);
+
+        printf("shm.%s.size_bytes=%zu\n", sim_segments[i], size);
+        printf("shm.%s.resident_bytes=%zu\n", sim_segments[i], resident * page);
+        total += size;
+        total_resident += resident * page;
+
+        if (!strcmp(sim_segments[i], "eucalyptusCCInstanceCache") && (size >= sizeof(ccInstanceCache))) {
+            printf("cc.instances=%d\n", ((ccInstanceCache *) buf)->numInsts);
+        } else if (!strcmp(sim_segments[i], "eucalyptusCCResourceCache") && (size >= sizeof(ccResourceCache))) {
+            printf("cc.resources=%d\n", ((ccResourceCache *) buf)->numResources);
+        }
+        munmap(buf, size);
+    }
+    printf("shm.total.size_bytes=%zu\n", total);
+    printf("shm.total.resident_bytes=%zu\n", total_resident);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int ch = 0;
+    int rc = 0;
+    int nodes = 0;
+    int enable = 0;
+    int use_wssec = 1;
+    int latency_ms = 0;
+    int failure_rate = 0;
+    int instances = 0;
+    long long start_ms = 0;
+    double seconds = 0.0;
+    char *home = NULL;
+    char *tmpstr = NULL;
+    char *networkInfoFile = NULL;
+    char configFile[EUCA_MAX_PATH] = "";
+    char policyFile[EUCA_MAX_PATH] = "";
+    char prefix[64] = "";
+    axis2_char_t *client_home = NULL;
+    axis2_char_t endpoint_uri[256] = "";
+    simWorker *workers = NULL;
+    message_stat *stat = NULL;
+    message_stat refresh = { 0 };
+    file_view xml = { 0 };
+    message_stat refresh_last = { 0 };
+
+    while ((ch = getopt(argc, argv, "t:r:d:m:b:v:n:ec:l:f:i:h")) != -1) {
+        switch (ch) {
+        case 't':
+            sim_threads = atoi(optarg);
+            break;
+        case 'r':
+            sim_rate = atof(optarg);
+            break;
+        case 'd':
+            sim_duration = atoi(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d:%d:%d", &sim_weights[SIM_RUN], &sim_weights[SIM_DESCRIBE], &sim_weights[SIM_TERMINATE], &sim_weights[SIM_NETWORK]) < 3) {
+                usage();
+                return (EUCA_ERROR);
+            }
+            break;
+        case 'b':
+            sim_batch = atoi(optarg);
+            break;
+        case 'v':
+            sim_vlan = atoi(optarg);
+            break;
+        case 'n':
+            networkInfoFile = optarg;
+            break;
+        case 'e':
+            enable = 1;
+            break;
+        case 'c':
+            nodes = atoi(optarg);
+            break;
+        case 'l':
+            latency_ms = atoi(optarg);
+            break;
+        case 'f':
+            failure_rate = atoi(optarg);
+            break;
+        case 'i':
+            instances = atoi(optarg);
+            break;
+        default:
+            usage();
+            return (EUCA_ERROR);
+        }
+    }
+
+    if (nodes > 0)
+        return (print_node_config(nodes, latency_ms, failure_rate, instances));
+
+    if ((optind != (argc - 1)) || (sim_threads < 1) || (sim_threads > SIM_MAX_THREADS) || (sim_rate <= 0) || (sim_duration < 1) || (sim_batch < 1)) {
+        usage();
+        return (EUCA_ERROR);
+    }
+
+    if (networkInfoFile) {
+        if (file_view_open(networkInfoFile, -1, &xml) != EUCA_OK) {
+            fprintf(stderr, "cannot read network information from %s\n", networkInfoFile);
+            return (EUCA_ERROR);
+        }
+        sim_network_info = base64_enc((u8 *) xml.data, xml.len);
+        file_view_close(&xml);
+    } else if (sim_weights[SIM_NETWORK] > 0) {
+        fprintf(stderr, "no network information given with -n, not sending BroadcastNetworkInfo\n");
+        sim_weights[SIM_NETWORK] = 0;
+    }
+
+    for (i = 0, sim_weights_total = 0; i < SIM_OPS; i++) {
+        sim_weights[i] = MAX(0, sim_weights[i]);
+        sim_weights_total += sim_weights[i];
+    }
+    if (sim_weights_total == 0) {
+        fprintf(stderr, "the operation mix is empty\n");
+        return (EUCA_ERROR);
+    }
+
+    euca_srand();
+    bzero(&mymeta, sizeof(ncMetadata));
+    mymeta.userId = strdup("admin");
+    mymeta.correlationId = strdup("ccsim");
+    mymeta.epoch = 3;
+    mymeta.servicesLen = 16;
+    snprintf(mymeta.services[15].name, 16, "eucalyptusname");
+    snprintf(mymeta.services[15].type, 16, "eucalyptustype");
+    snprintf(mymeta.services[15].partition, 16, "eucalyptuspart");
+    mymeta.services[15].urisLen = 1;
+    snprintf(mymeta.services[15].uris[0], 512, "http://localhost:8773/services/Eucalyptus");
+
+    if ((home = getenv(EUCALYPTUS_ENV_VAR_NAME)) == NULL)
+        home = "";
+    snprintf(configFile, EUCA_MAX_PATH, EUCALYPTUS_CONF_LOCATION, home);
+    snprintf(policyFile, EUCA_MAX_PATH, EUCALYPTUS_POLICIES_DIR "/cc-client-policy.xml", home);
+    if ((get_conf_var(configFile, "ENABLE_WS_SECURITY", &tmpstr) == 1) && strcmp(tmpstr, "Y")) {
+        use_wssec = 0;
+    }
+    EUCA_FREE(tmpstr);
+
+    if ((client_home = AXIS2_GETENV("AXIS2C_HOME")) == NULL) {
+        fprintf(stderr, "must have AXIS2C_HOME set\n");
+        return (EUCA_ERROR);
+    }
+    snprintf(endpoint_uri, 256, "http://%s/axis2/services/EucalyptusCC", argv[optind]);
+
+    if ((workers = EUCA_ZALLOC(sim_threads, sizeof(simWorker))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return (EUCA_ERROR);
+    }
+
+    for (i = 0; i < sim_threads; i++) {
+        workers[i].index = i;
+        workers[i].seed = rand();
+        workers[i].env = axutil_env_create_all(NULL, 0);
+        if ((workers[i].stub = axis2_stub_create_EucalyptusCC(workers[i].env, client_home, endpoint_uri)) == NULL) {
+            fprintf(stderr, "cannot create a stub for %s\n", endpoint_uri);
+            return (EUCA_ERROR);
+        }
+        if (use_wssec && ((rc = InitWSSEC(workers[i].env, workers[i].stub, policyFile)) != 0)) {
+            fprintf(stderr, "cannot initialize WS-SEC policy (%s)\n", policyFile);
+            return (EUCA_ERROR);
+        }
+    }
+
+    if (enable) {
+        cc_startService(workers[0].env, workers[0].stub);
+        cc_enableService(workers[0].env, workers[0].stub);
+    }
+
+    initialize_message_stats(&sim_stats);
+    enable_stats(&sim_stats);
+    sample_refresh_stat(&refresh, &refresh_last);
+    bzero(&refresh, sizeof(message_stat));
+    refresh.min_ms = MSG_MIN_INIT;
+    refresh.max_ms = MSG_MAX_INIT;
+
+    start_ms = time_ms();
+    for (i = 0; i < sim_threads; i++) {
+        if (pthread_create(&(workers[i].thread), NULL, sim_worker, &(workers[i])) != 0) {
+            fprintf(stderr, "cannot start request thread %d\n", i);
+            sim_running = 0;
+            sim_threads = i;
+        }
+    }
+
+    while (sim_running && ((time_ms() - start_ms) < (sim_duration * 1000LL))) {
+        sleep(1);
+        sample_refresh_stat(&refresh, &refresh_last);
+    }
+    sim_running = 0;
+    for (i = 0; i < sim_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    seconds = (time_ms() - start_ms) / 1000.0;
+    sample_refresh_stat(&refresh, &refresh_last);
+
+    printf("sim.threads=%d\n", sim_threads);
+    printf("sim.target_rate=%.2f\n", sim_rate);
+    printf("sim.duration_s=%.1f\n", seconds);
+    printf("sim.instances_tracked=%d\n", sim_pool_len);
+    printf("sim.instances_described=%lld\n", sim_instances_seen);
+    for (i = 0; i < MSG_STATS_MAX_MESSAGES; i++) {
+        stat = &(sim_stats.messages[i]);
+        if (stat->used == 2) {
+            snprintf(prefix, sizeof(prefix), "op.%s", stat->name);
+            print_stat(prefix, stat, seconds);
+        }
+    }
+    print_stat("cc." SIM_REFRESH_MESSAGE, &refresh, seconds);
+    print_shared_memory();
+    return (EUCA_OK);
+}
@@ -756,14 +756,19 @@ int cc_bundleRestartInstance(char *instanceId, axutil_env_t * env, axis2_stub_t
 //!
 int cc_broadcastNetworkInfo(char *networkInfo, axutil_env_t * env, axis2_stub_t * pStub)
 {
-    char *networkInfoFileBuf = NULL, *networkInfoBuf = NULL;
+    char *networkInfoBuf = NULL;
+    file_view networkInfoFile = { 0 };
     adb_BroadcastNetworkInfo_t *input = NULL;
     adb_BroadcastNetworkInfoResponse_t *output = NULL;
     adb_broadcastNetworkInfoType_t *sn = NULL;
     adb_broadcastNetworkInfoResponseType_t *snrt = NULL;
 
-    networkInfoFileBuf = file2str(networkInfo);
-    networkInfoBuf = base64_enc(((u8 *) networkInfoFileBuf), strlen(networkInfoFileBuf));
+    if (file_view_open(networkInfo, -1, &networkInfoFile) != EUCA_OK) {
+        printf("ERROR: cannot read network information from %s\n", networkInfo);
+        return (1);
+    }
+    networkInfoBuf = base64_enc(((u8 *) networkInfoFile.data), networkInfoFile.len);
+    file_view_close(&networkInfoFile);
 
     sn = adb_broadcastNetworkInfoType_create(env);
     input = adb_BroadcastNetworkInfo_create(env);
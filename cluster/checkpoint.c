@@ -0,0 +1,793 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/checkpoint.c
+//! Persistent checkpoint of the CC instance and resource caches.
+//!
+//! The caches live in memory mapped files which the init script removes on each stop, so a
+//! restarted CC used to start empty and had to poll every NC before it could answer anything.
+//! The checkpoint keeps a copy of the caches where the init script does not look:
+//!
+//!   * a journal, appended to by whichever CC process changes an instance cache slot, with
+//!     one record (the whole slot) per change;
+//!   * a snapshot of both caches, written by the monitor every CHECKPOINT_SNAPSHOT_INTERVAL
+//!     seconds, after which the journal records it covers are dropped.
+//!
+//! Records carry a sequence number kept in the instance cache, so restoring is loading the
+//! snapshot and replaying the journal records that are newer than it. A restored cache is
+//! only a starting point: each resource keeps the instance generation its NC last reported,
+//! so the first refresh_instances() asks every NC for what changed since the checkpoint and
+//! the instances the NCs no longer report age out through the usual instanceTimeout.
+//!
+//! A ccInstance is mostly zeros (user data, group names, unused volumes), so records store
+//! the slot in a zero-run packed form: (zero run, literal length) pairs followed by the
+//! literal bytes. The files are for this host only and use its byte order and structure
+//! layout; a snapshot whose layout does not match is ignored.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <hash.h>
+#include <log.h>
+#include <data.h>
+#include <vnetwork.h>
+
+#include "handlers.h"
+#include "checkpoint.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define CHECKPOINT_MAGIC                         "EUCACKPT" //!< first bytes of a snapshot file
+#define CHECKPOINT_VERSION                       1      //!< format of the snapshot and journal files
+#define CHECKPOINT_RECORD_MAGIC                  0x43435231 //!< first word of each record ("CCR1")
+#define CHECKPOINT_MIN_ZERO_RUN                  16     //!< shorter zero runs stay in the literal bytes
+#define CHECKPOINT_MAX_RECORD                    (sizeof(ccInstance) + 4096)   //!< packed data a sane record can have
+
+#define CHECKPOINT_SNAPSHOT                      "snapshot"
+#define CHECKPOINT_SNAPSHOT_TMP                  "snapshot.tmp"
+#define CHECKPOINT_JOURNAL                       "journal"
+#define CHECKPOINT_JOURNAL_PREV                  "journal.prev" //!< journal being folded into the next snapshot
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Header of a snapshot file, followed by numResources resource records and numInstances
+//! instance records
+typedef struct checkpointHeader_t {
+    char magic[8];                     //!< CHECKPOINT_MAGIC
+    u32 version;                       //!< CHECKPOINT_VERSION
+    u32 instanceSize;                  //!< sizeof(ccInstance) at the time the snapshot was written
+    u32 resourceSize;                  //!< sizeof(ccResource) at the time the snapshot was written
+    u32 volumeSize;                    //!< sizeof(ncVolume) at the time the snapshot was written
+    long long seq;                     //!< newest journal record the snapshot includes
+    time_t created;                    //!< when the snapshot was taken
+    int numResources;                  //!< number of resource records
+    int numInstances;                  //!< number of instance records
+} checkpointHeader;
+
+//! A resource or instance cache slot, followed by packedLen bytes of packed slot content
+typedef struct checkpointRecord_t {
+    u32 magic;                         //!< CHECKPOINT_RECORD_MAGIC
+    int slot;                          //!< the cache slot
+    int state;                         //!< the cacheState[] of the slot, slots not in use have no content
+    int volumes;                       //!< instance volumes included, up to the last one in use
+    long long seq;                     //!< journal sequence number of the change
+    time_t lastchanged;                //!< when the instance last changed
+    u32 packedLen;                     //!< number of packed bytes that follow
+    u32 checksum;                      //!< jenkins() of the packed bytes
+} checkpointRecord;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+extern ccConfig *config;
+extern ccInstanceCache *instanceCache;
+extern ccResourceCache *resourceCache;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static time_t checkpoint_last_snapshot = 0; //!< when this process last wrote a snapshot
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void checkpoint_path(char *path, const char *name);
+static void checkpoint_pack(FILE * fp, const void *buf, size_t len);
+static int checkpoint_unpack(const unsigned char *in, size_t inlen, size_t * pos, void *buf, size_t len);
+static int checkpoint_instance_volumes(const ccInstance * inst);
+static int checkpoint_put_record(FILE * fp, checkpointRecord * rec, const void *head, size_t headLen, const void *tail, size_t tailLen);
+static int checkpoint_put_instance(FILE * fp, int slot, long long seq);
+static int checkpoint_get_record(FILE * fp, checkpointRecord * rec, unsigned char **data);
+static int checkpoint_apply_instance(const checkpointRecord * rec, const unsigned char *data, time_t now);
+static int checkpoint_replay(const char *name, long long since, long long *lastseq, time_t now);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Builds the path of a checkpoint file
+//!
+//! @param[out] path the buffer for the path, EUCA_MAX_PATH long
+//! @param[in]  name the file name within CHECKPOINT_DIR, or NULL for the directory itself
+//!
+static void checkpoint_path(char *path, const char *name)
+{
+    char dir[EUCA_MAX_PATH] = "";
+
+    snprintf(dir, EUCA_MAX_PATH, CHECKPOINT_DIR, config->eucahome);
+    if (name) {
+        snprintf(path, EUCA_MAX_PATH, "%s/%s", dir, name);
+    } else {
+        snprintf(path, EUCA_MAX_PATH, "%s", dir);
+    }
+}
+
+//!
+//! Appends the zero-run packed form of a buffer to a stream
+//!
+//! @param[in] fp the stream to write to
+//! @param[in] buf the buffer to pack
+//! @param[in] len the number of bytes in buf
+//!
+static void checkpoint_pack(FILE * fp, const void *buf, size_t len)
+{
+    size_t i = 0;
+    size_t z = 0;
+    size_t lit = 0;
+    size_t end = 0;
+    u32 run[2] = { 0 };
+    const unsigned char *p = buf;
+
+    while (i < len) {
+        for (end = i; (end < len) && !p[end]; end++) ;
+
+        // the literal bytes go on until a zero run long enough to be worth a new pair
+        for (lit = end; lit < len;) {
+            if (p[lit]) {
+                lit++;
+                continue;
+            }
+
+            for (z = lit; (z < len) && !p[z]; z++) ;
+            if (((z - lit) >= CHECKPOINT_MIN_ZERO_RUN) || (z == len))
+                break;
+            lit = z;
+        }
+
+        run[0] = (end - i);
+        run[1] = (lit - end);
+        fwrite(run, sizeof(run), 1, fp);
+        fwrite(p + end, 1, (lit - end), fp);
+        i = lit;
+    }
+}
+
+//!
+//! Unpacks the zero-run packed form of a buffer, see checkpoint_pack()
+//!
+//! @param[in]     in the packed bytes
+//! @param[in]     inlen the number of packed bytes
+//! @param[in,out] pos where in the packed bytes the buffer starts, moved past it on return
+//! @param[out]    buf the buffer to unpack into
+//! @param[in]     len the number of bytes in buf
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the packed bytes do not make up the buffer
+//!
+static int checkpoint_unpack(const unsigned char *in, size_t inlen, size_t * pos, void *buf, size_t len)
+{
+    size_t o = 0;
+    size_t i = *pos;
+    u32 run[2] = { 0 };
+    unsigned char *out = buf;
+
+    while (o < len) {
+        if ((i + sizeof(run)) > inlen)
+            return (EUCA_ERROR);
+
+        memcpy(run, (in + i), sizeof(run));
+        i += sizeof(run);
+        if ((((size_t) run[0] + run[1]) > (len - o)) || (run[1] > (inlen - i)))
+            return (EUCA_ERROR);
+
+        memset((out + o), 0, run[0]);
+        o += run[0];
+        memcpy((out + o), (in + i), run[1]);
+        o += run[1];
+        i += run[1];
+    }
+
+    *pos = i;
+    return (EUCA_OK);
+}
+
+//!
+//! Tells how many of the volumes of an instance need to be kept
+//!
+//! @param[in] inst a pointer to the instance
+//!
+//! @return the index of the last volume in use plus one
+//!
+static int checkpoint_instance_volumes(const ccInstance * inst)
+{
+    int n = 0;
+
+    for (n = EUCA_MAX_VOLUMES; (n > 0) && (inst->volumes[n - 1].volumeId[0] == '\0'); n--) ;
+    return (n);
+}
+
+//!
+//! Writes a record and its content, given as one or two unpacked regions, to a stream
+//!
+//! @param[in] fp the stream to write to
+//! @param[in] rec the record header, packedLen and checksum are set here
+//! @param[in] head the first region of the slot content
+//! @param[in] headLen the number of bytes in head
+//! @param[in] tail the second region of the slot content, may be NULL
+//! @param[in] tailLen the number of bytes in tail
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int checkpoint_put_record(FILE * fp, checkpointRecord * rec, const void *head, size_t headLen, const void *tail, size_t tailLen)
+{
+    int ret = EUCA_OK;
+    char *packed = NULL;
+    size_t packedLen = 0;
+    FILE *pfp = NULL;
+
+    if ((pfp = open_memstream(&packed, &packedLen)) == NULL)
+        return (EUCA_ERROR);
+
+    if (head)
+        checkpoint_pack(pfp, head, headLen);
+    if (tail)
+        checkpoint_pack(pfp, tail, tailLen);
+    fclose(pfp);
+
+    rec->magic = CHECKPOINT_RECORD_MAGIC;
+    rec->packedLen = packedLen;
+    rec->checksum = jenkins(packed, packedLen);
+    if ((fwrite(rec, sizeof(checkpointRecord), 1, fp) != 1) || (fwrite(packed, 1, packedLen, fp) != packedLen))
+        ret = EUCA_ERROR;
+
+    EUCA_FREE(packed);
+    return (ret);
+}
+
+//!
+//! Writes the record of an instance cache slot to a stream
+//!
+//! @param[in] fp the stream to write to
+//! @param[in] slot the instance cache slot
+//! @param[in] seq the sequence number of the record
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static int checkpoint_put_instance(FILE * fp, int slot, long long seq)
+{
+    ccInstance *inst = &(instanceCache->instances[slot]);
+    checkpointRecord rec = { 0 };
+
+    rec.slot = slot;
+    rec.state = instanceCache->cacheState[slot];
+    rec.seq = seq;
+    rec.lastchanged = instanceCache->lastchanged[slot];
+    if (rec.state != INSTVALID)
+        return (checkpoint_put_record(fp, &rec, NULL, 0, NULL, 0));
+
+    rec.volumes = checkpoint_instance_volumes(inst);
+    return (checkpoint_put_record(fp, &rec, inst, (offsetof(ccInstance, volumes) + (rec.volumes * sizeof(ncVolume))),
+                                  &(inst->volumesSize), (sizeof(ccInstance) - offsetof(ccInstance, volumesSize))));
+}
+
+//!
+//! Reads the next record from a stream
+//!
+//! @param[in]  fp the stream to read from
+//! @param[out] rec the record header
+//! @param[out] data the packed content of the record, to be freed by the caller
+//!
+//! @return EUCA_OK on success, EUCA_NOT_FOUND_ERROR at the end of the stream or EUCA_ERROR
+//!         if the record is torn or damaged
+//!
+static int checkpoint_get_record(FILE * fp, checkpointRecord * rec, unsigned char **data)
+{
+    size_t got = 0;
+
+    *data = NULL;
+    if ((got = fread(rec, 1, sizeof(checkpointRecord), fp)) == 0)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    if ((got != sizeof(checkpointRecord)) || (rec->magic != CHECKPOINT_RECORD_MAGIC) || (rec->packedLen > CHECKPOINT_MAX_RECORD)
+        || (rec->volumes < 0) || (rec->volumes > EUCA_MAX_VOLUMES))
+        return (EUCA_ERROR);
+
+    if ((*data = EUCA_ALLOC((rec->packedLen + 1), sizeof(unsigned char))) == NULL)
+        return (EUCA_ERROR);
+
+    if ((fread(*data, 1, rec->packedLen, fp) != rec->packedLen) || (jenkins((char *)*data, rec->packedLen) != rec->checksum)) {
+        EUCA_FREE(*data);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Puts the content of an instance record into its instance cache slot
+//!
+//! @param[in] rec the record header
+//! @param[in] data the packed content of the record
+//! @param[in] now the time the restored instances are marked as last seen
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the record is inconsistent
+//!
+//! @note this should be called with INSTCACHE lock held; the summaries and indexes are
+//!       rebuilt by the caller once all records are in
+//!
+static int checkpoint_apply_instance(const checkpointRecord * rec, const unsigned char *data, time_t now)
+{
+    size_t pos = 0;
+    ccInstance *inst = NULL;
+
+    if ((rec->slot < 0) || (rec->slot >= MAXINSTANCES_PER_CC))
+        return (EUCA_ERROR);
+
+    inst = &(instanceCache->instances[rec->slot]);
+    bzero(inst, sizeof(ccInstance));
+    instanceCache->cacheState[rec->slot] = INSTINVALID;
+    instanceCache->lastseen[rec->slot] = 0;
+    instanceCache->lastchanged[rec->slot] = 0;
+    if (rec->state != INSTVALID)
+        return (EUCA_OK);
+
+    if ((checkpoint_unpack(data, rec->packedLen, &pos, inst, (offsetof(ccInstance, volumes) + (rec->volumes * sizeof(ncVolume)))) != EUCA_OK)
+        || (checkpoint_unpack(data, rec->packedLen, &pos, &(inst->volumesSize), (sizeof(ccInstance) - offsetof(ccInstance, volumesSize))) != EUCA_OK)
+        || (pos != rec->packedLen)) {
+        bzero(inst, sizeof(ccInstance));
+        return (EUCA_ERROR);
+    }
+
+    instanceCache->cacheState[rec->slot] = INSTVALID;
+    instanceCache->lastseen[rec->slot] = now;
+    instanceCache->lastchanged[rec->slot] = rec->lastchanged;
+    return (EUCA_OK);
+}
+
+//!
+//! Replays the records of a journal file that are newer than a snapshot
+//!
+//! @param[in]     name the journal file name
+//! @param[in]     since the sequence number of the snapshot
+//! @param[in,out] lastseq the highest sequence number seen so far
+//! @param[in]     now the time the restored instances are marked as last seen
+//!
+//! @return the number of records replayed
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static int checkpoint_replay(const char *name, long long since, long long *lastseq, time_t now)
+{
+    int rc = 0;
+    int count = 0;
+    char path[EUCA_MAX_PATH] = "";
+    unsigned char *data = NULL;
+    FILE *fp = NULL;
+    checkpointRecord rec = { 0 };
+
+    checkpoint_path(path, name);
+    if ((fp = fopen(path, "r")) == NULL)
+        return (0);
+
+    while ((rc = checkpoint_get_record(fp, &rec, &data)) == EUCA_OK) {
+        if (rec.seq > since) {
+            if (checkpoint_apply_instance(&rec, data, now) == EUCA_OK) {
+                count++;
+            } else {
+                LOGWARN("skipping inconsistent record for instance cache slot %d in %s\n", rec.slot, path);
+            }
+            if (rec.seq > *lastseq)
+                *lastseq = rec.seq;
+        }
+        EUCA_FREE(data);
+    }
+
+    // a CC going down in the middle of an append leaves a torn record at the end
+    if (rc == EUCA_ERROR)
+        LOGWARN("ignoring the rest of %s after %d record(s), it is damaged or was cut short\n", path, count);
+    fclose(fp);
+    return (count);
+}
+
+//!
+//! Appends the current content of an instance cache slot to the checkpoint journal. The
+//! instance cache functions call this each time a slot changes.
+//!
+//! @param[in] slot the instance cache slot that changed
+//!
+//! @return EUCA_OK on success (or if checkpoints are not in use) or EUCA_ERROR on failure
+//!
+//! @note this should be called with INSTCACHE lock held, which keeps the records of the
+//!       CC processes in sequence order
+//!
+int checkpoint_journal_slot(int slot)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    char path[EUCA_MAX_PATH] = "";
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *fp = NULL;
+
+    if (!config || !config->use_checkpoint || (slot < 0) || (slot >= MAXINSTANCES_PER_CC))
+        return (EUCA_OK);
+
+    if ((fp = open_memstream(&buf, &len)) == NULL)
+        return (EUCA_ERROR);
+    ret = checkpoint_put_instance(fp, slot, ++instanceCache->ckptSeq);
+    fclose(fp);
+
+    // the record goes out in a single append, so records from different processes never mix
+    checkpoint_path(path, CHECKPOINT_JOURNAL);
+    if ((ret == EUCA_OK) && ((fd = open(path, (O_WRONLY | O_APPEND | O_CREAT), 0600)) < 0) && (errno == ENOENT)) {
+        checkpoint_path(path, NULL);
+        mkdir(path, 0700);
+        checkpoint_path(path, CHECKPOINT_JOURNAL);
+        fd = open(path, (O_WRONLY | O_APPEND | O_CREAT), 0600);
+    }
+
+    if ((ret != EUCA_OK) || (fd < 0) || (write(fd, buf, len) != len)) {
+        LOGWARN("cannot journal the change of instance cache slot %d to %s\n", slot, path);
+        ret = EUCA_ERROR;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    EUCA_FREE(buf);
+    return (ret);
+}
+
+//!
+//! Writes a snapshot of the resource and instance caches, if it is time to. Snapshots
+//! are taken every CHECKPOINT_SNAPSHOT_INTERVAL seconds, or sooner once the journal
+//! grows past CHECKPOINT_JOURNAL_MAX bytes.
+//!
+//! @param[in] force set to TRUE to write a snapshot now
+//!
+//! @return EUCA_OK on success (or if no snapshot was due) or EUCA_ERROR on failure
+//!
+//! @note this must be called without the RESCACHE and INSTCACHE locks held
+//!
+int checkpoint_snapshot(boolean force)
+{
+    int i = 0;
+    int fd = -1;
+    int ret = EUCA_OK;
+    char path[EUCA_MAX_PATH] = "";
+    char prev[EUCA_MAX_PATH] = "";
+    char tmp[EUCA_MAX_PATH] = "";
+    char *body = NULL;
+    size_t bodyLen = 0;
+    time_t now = time(NULL);
+    FILE *fp = NULL;
+    struct stat mystat = { 0 };
+    checkpointHeader header = { {0} };
+    checkpointRecord rec = { 0 };
+    ccResourceCache *resources = NULL;
+
+    if (!config || !config->use_checkpoint)
+        return (EUCA_OK);
+
+    checkpoint_path(path, CHECKPOINT_JOURNAL);
+    if (stat(path, &mystat) != 0)
+        mystat.st_size = 0;
+
+    if (!force && checkpoint_last_snapshot && ((now - checkpoint_last_snapshot) < CHECKPOINT_SNAPSHOT_INTERVAL) && (mystat.st_size < CHECKPOINT_JOURNAL_MAX))
+        return (EUCA_OK);
+    checkpoint_last_snapshot = now;
+
+    if ((resources = EUCA_ALLOC(1, sizeof(ccResourceCache))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    sem_mywait(RESCACHE);
+    memcpy(resources, resourceCache, sizeof(ccResourceCache));
+    sem_mypost(RESCACHE);
+
+    if ((fp = open_memstream(&body, &bodyLen)) == NULL) {
+        EUCA_FREE(resources);
+        return (EUCA_ERROR);
+    }
+
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.instanceSize = sizeof(ccInstance);
+    header.resourceSize = sizeof(ccResource);
+    header.volumeSize = sizeof(ncVolume);
+    header.created = now;
+    for (i = 0; (i < resources->numResources) && (i < MAXNODES) && (ret == EUCA_OK); i++) {
+        bzero(&rec, sizeof(rec));
+        rec.slot = i;
+        rec.state = resources->cacheState[i];
+        ret = checkpoint_put_record(fp, &rec, &(resources->resources[i]), sizeof(ccResource), NULL, 0);
+        header.numResources++;
+    }
+    EUCA_FREE(resources);
+
+    checkpoint_path(prev, CHECKPOINT_JOURNAL_PREV);
+    sem_mywait(INSTCACHE);
+    {
+        header.seq = instanceCache->ckptSeq;
+        for (i = 0; (i < MAXINSTANCES_PER_CC) && (ret == EUCA_OK); i++) {
+            if (instanceCache->cacheState[i] == INSTVALID) {
+                ret = checkpoint_put_instance(fp, i, header.seq);
+                header.numInstances++;
+            }
+        }
+
+        // the journal records up to header.seq are in the snapshot once it is written. If an
+        // earlier snapshot failed, its journal.prev is still around and new records stay in
+        // the journal, the restore skips the ones the snapshot already covers.
+        if ((ret == EUCA_OK) && (access(prev, F_OK) != 0))
+            rename(path, prev);
+    }
+    sem_mypost(INSTCACHE);
+    fclose(fp);
+
+    if (ret == EUCA_OK) {
+        checkpoint_path(path, NULL);
+        mkdir(path, 0700);
+        checkpoint_path(path, CHECKPOINT_SNAPSHOT);
+        checkpoint_path(tmp, CHECKPOINT_SNAPSHOT_TMP);
+        if (((fd = open(tmp, (O_WRONLY | O_CREAT | O_TRUNC), 0600)) < 0) || ((fp = fdopen(fd, "w")) == NULL)) {
+            if (fd >= 0)
+                close(fd);
+            ret = EUCA_ERROR;
+        } else {
+            if ((fwrite(&header, sizeof(header), 1, fp) != 1) || (fwrite(body, 1, bodyLen, fp) != bodyLen) || fflush(fp) || fsync(fileno(fp)))
+                ret = EUCA_ERROR;
+            if (fclose(fp) || (ret != EUCA_OK) || rename(tmp, path)) {
+                unlink(tmp);
+                ret = EUCA_ERROR;
+            } else {
+                unlink(prev);
+            }
+        }
+    }
+    EUCA_FREE(body);
+
+    if (ret != EUCA_OK) {
+        LOGWARN("cannot write the cache checkpoint to %s\n", path);
+        return (EUCA_ERROR);
+    }
+
+    LOGDEBUG("checkpointed %d node(s) and %d instance(s) in %ld bytes (journal up to %lld)\n", header.numResources, header.numInstances,
+             (long)(sizeof(header) + bodyLen), header.seq);
+    return (EUCA_OK);
+}
+
+//!
+//! Restores the resource and instance caches from the checkpoint. This is only done when both
+//! caches are empty, that is when the CC was stopped (rather than just restarted with its cache
+//! files in place) and is the first process to set up its configuration.
+//!
+//! @return EUCA_OK on success or if there was nothing to restore, EUCA_ERROR if the checkpoint
+//!         cannot be used
+//!
+//! @note this should be called with INIT lock held, before the configured nodes are put in
+//!       the resource cache. The caller rebuilds the instance cache indexes.
+//!
+int checkpoint_restore(void)
+{
+    int i = 0;
+    int rc = 0;
+    int numResources = 0;
+    int numInstances = 0;
+    int replayed = 0;
+    char path[EUCA_MAX_PATH] = "";
+    long long lastseq = 0;
+    time_t now = time(NULL);
+    size_t pos = 0;
+    unsigned char *data = NULL;
+    FILE *fp = NULL;
+    checkpointHeader header = { {0} };
+    checkpointRecord rec = { 0 };
+
+    if (!config || !config->use_checkpoint)
+        return (EUCA_OK);
+
+    if ((resourceCache->numResources > 0) || (instanceCache->numInsts > 0)) {
+        LOGDEBUG("cache files in place, not restoring from the checkpoint\n");
+        return (EUCA_OK);
+    }
+
+    checkpoint_path(path, CHECKPOINT_SNAPSHOT);
+    if ((fp = fopen(path, "r")) == NULL)
+        return (EUCA_OK);
+
+    if ((fread(&header, sizeof(header), 1, fp) != 1) || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) || (header.version != CHECKPOINT_VERSION)
+        || (header.instanceSize != sizeof(ccInstance)) || (header.resourceSize != sizeof(ccResource)) || (header.volumeSize != sizeof(ncVolume))
+        || (header.numResources < 0) || (header.numResources > MAXNODES) || (header.numInstances < 0) || (header.numInstances > MAXINSTANCES_PER_CC)) {
+        LOGWARN("ignoring checkpoint %s, it was written by a different version or is damaged\n", path);
+        fclose(fp);
+        return (EUCA_ERROR);
+    }
+
+    if ((now - header.created) > CHECKPOINT_MAX_AGE) {
+        LOGINFO("ignoring checkpoint %s, it is %ld seconds old\n", path, (long)(now - header.created));
+        fclose(fp);
+        return (EUCA_OK);
+    }
+
+    sem_mywait(RESCACHE);
+    {
+        for (i = 0, rc = EUCA_OK; (i < header.numResources) && (rc == EUCA_OK); i++) {
+            pos = 0;
+            if (((rc = checkpoint_get_record(fp, &rec, &data)) == EUCA_OK) && ((rec.slot != i)
+                                                                              || (checkpoint_unpack(data, rec.packedLen, &pos, &(resourceCache->resources[i]),
+                                                                                                    sizeof(ccResource)) != EUCA_OK) || (pos != rec.packedLen))) {
+                rc = EUCA_ERROR;
+            }
+            resourceCache->cacheState[i] = rec.state;
+            EUCA_FREE(data);
+        }
+
+        if (rc == EUCA_OK) {
+            // the latency histograms and the last update time describe the CC before the restart
+            for (i = 0; i < header.numResources; i++) {
+                bzero(resourceCache->resources[i].latency, sizeof(resourceCache->resources[i].latency));
+            }
+            resourceCache->numResources = numResources = header.numResources;
+            resourceCache->lastResourceUpdate = 0;
+        } else {
+            bzero(resourceCache->resources, sizeof(resourceCache->resources));
+            bzero(resourceCache->cacheState, sizeof(resourceCache->cacheState));
+        }
+        // the per VM type availability gets counted again from the restored nodes
+        resourceCache->typesValid = FALSE;
+    }
+    sem_mypost(RESCACHE);
+
+    if (rc != EUCA_OK) {
+        LOGWARN("ignoring checkpoint %s, its node records are damaged\n", path);
+        fclose(fp);
+        return (EUCA_ERROR);
+    }
+
+    sem_mywait(INSTCACHE);
+    {
+        for (i = 0; i < header.numInstances; i++) {
+            if ((rc = checkpoint_get_record(fp, &rec, &data)) != EUCA_OK)
+                break;
+            if (checkpoint_apply_instance(&rec, data, now) != EUCA_OK)
+                LOGWARN("skipping inconsistent record for instance cache slot %d in %s\n", rec.slot, path);
+            EUCA_FREE(data);
+        }
+        if (i < header.numInstances)
+            LOGWARN("checkpoint %s was cut short after %d of its %d instance(s)\n", path, i, header.numInstances);
+
+        lastseq = header.seq;
+        replayed += checkpoint_replay(CHECKPOINT_JOURNAL_PREV, header.seq, &lastseq, now);
+        replayed += checkpoint_replay(CHECKPOINT_JOURNAL, header.seq, &lastseq, now);
+
+        for (i = 0, numInstances = 0; i < MAXINSTANCES_PER_CC; i++) {
+            if (instanceCache->cacheState[i] == INSTVALID)
+                numInstances++;
+        }
+        instanceCache->numInsts = numInstances;
+        instanceCache->ckptSeq = lastseq;
+
+        // nothing in here has been confirmed by an NC yet
+        instanceCache->dirty = 1;
+    }
+    sem_mypost(INSTCACHE);
+    fclose(fp);
+
+    LOGINFO("restored %d node(s) and %d instance(s) from the checkpoint taken %ld seconds ago (%d journal record(s) replayed)\n", numResources, numInstances,
+            (long)(now - header.created), replayed);
+    return (EUCA_OK);
+}
@@ -67,15 +67,27 @@
 #define INCLUDE_CONFIG_CC_H
 
 #include "stats.h"
+#include "metrics_exporter.h"
+#include "fs_emitter.h"
 
 configEntry configKeysRestartCC[] = {
+    {"CC_CHECKPOINT", "Y"}
+    ,
+    {"CC_MAX_SENSOR_RESOURCES", NULL}
+    ,
+    {"CC_SHARED_HUGEPAGES", NULL}
+    ,
+    {"CC_SHARED_PREFAULT", "N"}
+    ,
     {"DISABLE_TUNNELING", "N"}
     ,
     {"ENABLE_WS_SECURITY", "Y"}
     ,
     {"EUCALYPTUS", "/"}
     ,
-    {"NC_FANOUT", "1"}
+    {"NC_CONNECTION_POOL", "Y"}
+    ,
+    {"NC_FANOUT", "0"}
     ,
     {"NC_PORT", "8775"}
     ,
@@ -117,18 +129,30 @@ configEntry configKeysRestartCC[] = {
     ,
     {"VNET_SUBNET", NULL}
     ,
+    {"VNET_TUNNEL_MODE", "VTUN"}
+    ,
     {"VNET_MACPREFIX", "d0:0d"}
     ,
     {"POWER_IDLETHRESH", "300"}
     ,
     {"POWER_WAKETHRESH", "300"}
     ,
+    {"POWER_CONSOLIDATETHRESH", "0"}
+    ,
     {"CC_IMAGE_PROXY", NULL}
     ,
     {"CC_IMAGE_PROXY_CACHE_SIZE", "32768"}
     ,
     {"CC_IMAGE_PROXY_PATH", NULL}
     ,
+    {"CC_MIGRATION_MAX_PER_SOURCE", "2"}
+    ,
+    {"CC_MIGRATION_MAX_PER_DEST", "2"}
+    ,
+    {METRICS_LISTEN_CONF_PARAM_NAME, METRICS_LISTEN_CONF_PARAM_DEFAULT}
+    ,
+    {EMITTER_MODE_CONF_PARAM_NAME, EMITTER_MODE_CONF_PARAM_DEFAULT}
+    ,
     {NULL, NULL}
     ,
 };
@@ -138,6 +162,10 @@ configEntry configKeysNoRestartCC[] = {
     ,
     {"NC_POLLING_FREQUENCY", "6"}
     ,
+    {"NC_POLLING_MIN", NULL}
+    ,
+    {"NC_POLLING_MAX", NULL}
+    ,
     {"CLC_POLLING_FREQUENCY", "6"}
     ,
     {"CC_ARBITRATORS", NULL}
@@ -152,6 +180,8 @@ configEntry configKeysNoRestartCC[] = {
     ,
     {"LOGFACILITY", ""}
     ,
+    {"LOGASYNC", "N"}
+    ,
     {SENSOR_LIST_CONF_PARAM_NAME, SENSOR_LIST_CONF_PARAM_DEFAULT}
     ,
     {NULL, NULL}
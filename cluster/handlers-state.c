@@ -105,6 +105,7 @@
 #include <storage-windows.h>
 #include <euca_auth.h>
 #include <handlers-state.h>
+#include <checkpoint.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -699,6 +700,9 @@ int doShutdownService(ncMetadata * pMeta)
     }
     sem_mypost(CONFIG);
 
+    // the next start picks up from here
+    checkpoint_snapshot(TRUE);
+
     LOGTRACE("done\n");
     return (ret);
 }
@@ -80,12 +80,17 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 #include <semaphore.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
 #include <math.h>
 #include <assert.h>
 #include <json/json.h>
@@ -98,6 +103,7 @@
 #include <vnetwork.h>
 #include <misc.h>
 #include <ipc.h>
+#include <hash.h>
 #include <objectstorage.h>
 #include <http.h>
 #include <globalnetwork.h>
@@ -112,16 +118,26 @@
 #include <euca_auth.h>
 
 #include <handlers-state.h>
+#include <checkpoint.h>
+#include <image_proxy.h>
+#include <scheduler.h>
 #include <fault.h>
 #include <euca_string.h>
+#include <euca_file.h>
 #include <axutil_error.h>
+#if defined(HAVE_ZLIB_H)
+#include <zlib.h>
+#endif /* HAVE_ZLIB_H */
 
 #include <ebs_utils.h>
+#include <trace.h>
+#include <euca_probe.h>
 
 #include <stats.h>
 #include <message_stats.h>
 #include <message_sensor.h>
 #include <service_sensor.h>
+#include <alloc_sensor.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -147,12 +163,188 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Progress of an instance through doRunInstances()
+enum {
+    RUNSLOT_NONE,                      //!< not going to run (no network or no resource)
+    RUNSLOT_PENDING,                   //!< waiting to be placed
+    RUNSLOT_PLACED,                    //!< capacity reserved, being dispatched to its NC
+    RUNSLOT_RUNNING,                   //!< accepted by its NC
+};
+
+//! How an NC took the network info, the exit code of its broadcast_network_info() child
+enum {
+    NETINFO_CURRENT = 0,               //!< the NC has the current network info
+    NETINFO_FAILED = 1,                //!< the NC did not take the network info (a killed child gives 1 too)
+    NETINFO_PLAIN = 2,                 //!< the NC has the current network info, but only takes the plain form
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! State of one fan-out of per-NC child processes over resourceCacheStage[], see nc_fanout_fork()
+typedef struct ncFanoutState_t {
+    int num;                           //!< number of NCs being polled
+    int limit;                         //!< maximum number of children running at once
+    int outstanding;                   //!< number of children not yet reaped
+    int latencyOp;                     //!< per-NC latency histogram to update (NCLAT_*), or -1 for none
+    pid_t *pids;                       //!< child polling each NC (0 once reaped or if never started)
+    long long *startMs;                //!< when the child polling each NC was started
+    long long *termMs;                 //!< when the child polling each NC was sent SIGTERM at its deadline, 0 if not
+    boolean *measured;                 //!< set for NCs whose latency is being recorded
+    int timeout;                       //!< seconds a child may run before it is terminated
+    int *results;                      //!< if set by the caller, gets the exit code of each child (-1 if it cannot be known)
+} ncFanoutState;
+
+//! A commit or rollback that the poll of a node decided on, see migration_handler()
+typedef struct migrationAction_t {
+    char *node;                        //!< node to send the action to
+    char *instance;                    //!< instance being migrated
+    char *action;                      //!< "commit" or "rollback"
+} migrationAction;
+
+//! One instance of a RunInstances request, from placement to the answer of its NC
+typedef struct ccRunSlot_t {
+    char instId[16];                   //!< instance identifier
+    char uuid[48];                     //!< instance UUID
+    char mac[32];                      //!< MAC address allocated to the instance
+    netConfig ncnet;                   //!< network configuration sent to the NC
+    int state;                         //!< RUNSLOT_* state of the instance
+    int resid;                         //!< resource the instance is placed on, -1 if none
+    int rc;                            //!< result written by the dispatching child: 0 started, 1 NC failure, -1 never sent
+} ccRunSlot;
+
+//! Arguments of an NC operation, unpacked once from the variable arguments of ncClientCall()
+typedef union ncOpArgs_t {
+    char *string;                      //!< the only argument of the operations taking an instance ID, the network info or a node state
+    struct {
+        char *instanceId;
+        char **consoleOutput;
+    } getConsoleOutput;
+    struct {
+        char *instanceId;
+        char *volumeId;
+        char *remoteDev;
+        char *localDev;
+        int force;
+    } volume;                          //!< ncAttachVolume, ncDetachVolume and ncCreateImage
+    struct {
+        char *instanceId;
+        char *publicIp;
+    } assignAddress;
+    struct {
+        char *instanceId;
+        int force;
+        int *shutdownState;
+        int *previousState;
+    } terminateInstance;
+    struct {
+        char *uuid;
+        char **peers;
+        int peersLen;
+        int port;
+        int vlan;
+        char **outStatus;
+    } startNetwork;
+    struct {
+        char *uuid;
+        char *instanceId;
+        char *reservationId;
+        virtualMachine *ncvm;
+        char *imageId;
+        char *imageURL;
+        char *kernelId;
+        char *kernelURL;
+        char *ramdiskId;
+        char *ramdiskURL;
+        char *ownerId;
+        char *accountId;
+        char *keyName;
+        netConfig *ncnet;
+        char *userData;
+        char *credential;
+        char *launchIndex;
+        char *platform;
+        int expiryTime;
+        char **netNames;
+        int netNamesLen;
+        char *rootDirective;
+        ncInstance **outInst;
+    } runInstance;
+    struct {
+        char **instIds;
+        int instIdsLen;
+        ncInstance ***outInsts;
+        int *outInstsLen;
+    } describeInstances;
+    struct {
+        long long sinceGeneration;
+        ncInstance ***outInsts;
+        int *outInstsLen;
+        char ***unchangedIds;
+        int *unchangedIdsLen;
+        long long *generation;
+    } describeInstancesDelta;
+    struct {
+        char *resourceType;
+        ncResource **outRes;
+        char **errMsg;
+    } describeResource;
+    struct {
+        int historySize;
+        long long collectionIntervalTimeMs;
+        char **instIds;
+        int instIdsLen;
+        char **sensorIds;
+        int sensorIdsLen;
+        char *cursors;                 //!< only for ncDescribeSensorsBatched
+        sensorResource ***srs;
+        int *srsLen;
+    } describeSensors;
+    struct {
+        char *instanceId;
+        char *bucketName;
+        char *filePrefix;
+        char *objectStorageURL;
+        char *userPublicKey;
+        char *S3Policy;
+        char *S3PolicySig;
+        char *architecture;
+    } bundleInstance;
+    struct {
+        ncInstance **instances;
+        int instancesLen;
+        char *action;
+        char *credentials;
+    } migrateInstances;
+    struct {
+        char **instIds;
+        int instIdsLen;
+        int force;                     //!< only for ncTerminateInstances
+    } instanceList;                    //!< ncTerminateInstances and ncRebootInstances
+} ncOpArgs;
+
+//! An NC operation, as performed by ncClientCall()
+typedef struct ncOperation_t {
+    const char *name;                  //!< name of the operation, for the logs and the traces
+    boolean replies;                   //!< the reply string of the NC is handed back in pMeta->replyString
+    void (*unpack) (ncOpArgs * args, va_list * al); //!< reads the variable arguments of ncClientCall()
+    int (*call) (ncStub * ncs, ncMetadata * meta, ncOpArgs * args); //!< calls the stub, leaving the outputs set only on success
+    int (*write) (int fd, ncOpArgs * args, int rc); //!< sends the outputs from the forked child and returns the result, NULL if none
+    int (*read) (int fd, ncOpArgs * args, int timeout);    //!< clears the outputs and receives them if timeout is set, NULL if none
+} ncOperation;
+
+//! A periodic job of the monitor, together with its entry in config->monitorTasks[]
+typedef struct monitorTaskDef_t {
+    const char *name;                  //!< name of the task, for the logs and the message stats
+    int (*run) (ncMetadata * pMeta);   //!< does one run of the task, returns non-zero on failure
+    time_t (*period) (void);           //!< seconds from the start of one run to the start of the next
+    time_t deadline;                   //!< seconds a run may take before it is reported as an overrun
+    boolean retry;                     //!< a failed run is tried again after MONITOR_TASK_RETRY_SEC rather than a period
+} monitorTaskDef;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -186,9 +378,8 @@ globalNetworkInfo *globalnetworkinfo = NULL;
 ccResourceCache *resourceCache = NULL; // canonical source for latest information about resources
 ccResourceCache *resourceCacheStage = NULL; // clone of resourceCache used for aggregating replies from NCs (via child procs)
 sensorResourceCache *ccSensorResourceCache = NULL;  // canonical source for latest sensor data, both local and from NCs
-char *message_stats_shared_mem = NULL; //Reference to the shared memory region
-char message_stats_cache[MESSAGE_STATS_MEMORY_REGION_SIZE]; //The proc local holder for cached copies of message_stats_shared_mem to avoid realloc for each cache copy.
-json_object *stats_cache_json = NULL; //! Pointer to parsed stats from the cache
+message_stats_state *message_stats_shared_mem = NULL; //Reference to the shared memory region, updated in place by all CC processes
+trace_ring *trace_ring_shared_mem = NULL;   //!< Tracing spans of all CC processes, recorded in place
 
 //! @}
 
@@ -208,6 +399,8 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
     "ROUNDROBIN",
     "POWERSAVE",
     "USER",
+    "BINPACK",
+    "SPREAD",
 };
 
 /*----------------------------------------------------------------------------*\
@@ -216,6 +409,38 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Process-local pool of long-lived NC stubs (one slot per node URL), see ncStubPoolAcquire()
+static struct {
+    char ncURL[384];                   //!< URL of the node this stub talks to (empty if slot is free)
+    ncStub *stub;                      //!< the Axis2 stub, created once and reused across calls
+    pid_t owner;                       //!< process which created the stub, stubs never cross a fork()
+    int calls;                         //!< number of calls made through this stub so far
+} ncStubPool[MAXNODES];
+
+//! Version of the network info each NC has, so that unchanged network info goes out as a version token
+//! only, see broadcast_network_info(). Kept by the process doing the broadcasts.
+static struct {
+    char ncURL[384];                   //!< URL of the node this slot is for (empty if slot is free)
+    char version[NETWORK_INFO_VERSION_LEN]; //!< MD5 of the network info XML the node took last
+    boolean plain;                     //!< the node turned down the compressed form, it gets the plain one
+} ncNetworkInfoAcks[MAXNODES];
+
+//! How the shared segments are backed, read from the configuration by init_thread() before mapping them
+static struct {
+    char hugepageDir[EUCA_MAX_PATH];   //!< hugetlbfs mount the segments go in, empty to keep them in the state directory
+    boolean prefault;                  //!< fault every page of a segment in when mapping it, rather than on first use
+    int maxSensorResources;            //!< number of resources the sensor cache is sized for
+} sharedBufferOpts = { "", FALSE, MAX_SENSOR_RESOURCES };
+
+//! Upper bounds, in milliseconds, of the ncLatency histogram buckets (the last bucket is open-ended)
+static const int nc_latency_bounds_ms[NC_LATENCY_BUCKETS - 1] = { 100, 250, 500, 1000, 2500, 5000, 10000 };
+
+//! Names of the requests tracked by ncLatency, indexed by NCLAT_*
+static const char *nc_latency_names[NCLAT_LAST] = {
+    "DescribeResource",
+    "DescribeInstances",
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -228,10 +453,82 @@ static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolea
 static int schedule_instance_migration(ncInstance * instance, char **includeNodes, char **excludeNodes, int includeNodeCount, int excludeNodeCount, int inresid, int *outresid,
                                        ccResourceCache * resourceCacheLocal, char **replyString);
 static int migration_handler(ccInstance * myInstance, char *host, char *src, char *dst, migration_states migration_state, char **node, char **instance, char **action);
+static void reserve_migration_capacity(int resid, virtualMachine * vm, int count);
+static boolean reserve_migration_commit(char *instanceId, char *src, char *dst);
+static void release_migration_commit(char *instanceId);
+static void print_migration_progress(void);
 static int populateOutboundMeta(ncMetadata * pMeta);
+static void remove_windows_files(const char *instId);
+static char *instanceCacheIndexKey(int idx, ccInstanceSummary * inst);
+static int instanceCacheIndexBucket(const char *key);
+static void instanceCacheIndexInsert(int idx, int slot);
+static void instanceCacheIndexRemove(int idx, int slot);
+static int instanceCacheIndexFind(int idx, const char *key);
+static int instanceCacheSlotCmp(const void *a, const void *b);
+static int instanceCacheGroupChain(int grp, const char *skey, int ikey);
+static boolean instanceCacheGroupMatch(int grp, int slot, const char *skey, int ikey);
+static void instanceCacheGroupLink(int grp, int slot);
+static void instanceCacheGroupUnlink(int grp, int slot);
+static int instanceCacheGroupNext(int grp, const char *skey, int ikey, int slot);
+static void index_instanceCacheSlot(int slot);
+static void unindex_instanceCacheSlot(int slot);
+static void rebuild_instanceCacheIndex(void);
+static int map_instanceCacheSlot(int slot, int (*operate) (ccInstance *, void *), void *operateParam);
+static boolean instanceCacheQueryMatch(int slot, ccInstanceQuery * query);
+static void resourceCacheWriteBegin(void);
+static void resourceCacheWriteEnd(void);
+static int resourceTypeFit(ccResourceType * type, int mem, int disk, int cores);
+static void count_resourceCacheNode(int idx);
+static void recount_resourceCacheTypes(void);
+static int awakeHostnameCmp(ccResource * res, void *hostname);
+static void nc_fanout_begin(ncFanoutState * fan, int num, int latencyOp);
+static pid_t nc_fanout_fork(ncFanoutState * fan, int idx, boolean measure);
+static int nc_fanout_reap(ncFanoutState * fan, boolean wait_for_one);
+static void nc_fanout_end(ncFanoutState * fan);
+static void nc_fanout_child_term(int sig);
+static int ncNetworkInfoAckSlot(const char *ncURL);
+static char *pack_network_info(const char *xml, const char *version);
+static void nc_latency_record(ncLatency * lat, long long ms, boolean timedout);
+static int nc_latency_cmp(const void *a, const void *b);
+static int nc_adaptive_timeout(ccResource * res, int latencyOp, int timeout);
+static boolean nc_health_allow(ccResource * res);
+static void nc_health_record(ccResource * res, boolean ok);
+static boolean nc_poll_due(ccResource * res, time_t lastPoll);
+static void nc_poll_adapt(ccResource * res, boolean busy);
+static void nc_poll_hurry(ccResource * res);
+static boolean instance_in_transition(const char *state, migration_states migration_state);
+static void nc_polling_bounds(time_t frequency, time_t instanceTimeout, time_t * pMin, time_t * pMax);
+static void print_ncLatency(ccResource * res);
+static int ncStubPoolAcquire(char *ncURL, int timeout);
+static void ncStubPoolRelease(int slot, int failed);
+static ncMetadata *ncClientCallMeta(ncMetadata * pMeta, const ncOperation * op);
+static void ncClientCallMetaFree(ncMetadata * localmeta, const ncOperation * op);
+static int ncClientCallPooled(ncMetadata * pMeta, ncStub * ncs, const ncOperation * op, ncOpArgs * args);
 static int initialize_stats_system(int interval_sec);
-static json_object **message_stats_getter();
-static void message_stats_setter();
+static time_t monitor_period_nc(void);
+static time_t monitor_period_nc_poll(void);
+static time_t monitor_period_clc(void);
+static time_t monitor_period_sensors(void);
+static time_t monitor_period_second(void);
+static time_t monitor_period_summary(void);
+static time_t monitor_period_idle(void);
+static int monitor_run_resources(ncMetadata * pMeta);
+static int monitor_run_instances(ncMetadata * pMeta);
+static int monitor_run_sensors(ncMetadata * pMeta);
+static int monitor_run_broadcast(ncMetadata * pMeta);
+static int monitor_run_network(ncMetadata * pMeta);
+static int monitor_run_clc(ncMetadata * pMeta);
+static int monitor_run_proxy(ncMetadata * pMeta);
+static boolean image_proxy_node_allowed(const char *ip);
+static int monitor_run_consolidate(ncMetadata * pMeta);
+static int monitor_run_summary(ncMetadata * pMeta);
+static int monitor_run_events(ncMetadata * pMeta);
+static void monitor_task_worker(int task, pid_t monitor, ncMetadata * pMeta);
+static void monitor_task_start(int task, ncMetadata * pMeta);
+static char *shared_buffer_option(const char *name);
+static void read_shared_buffer_options(void);
+static int setup_hugepage_buffer(void **buf, char *bufname, size_t bytes);
+static message_stats_state *message_stats_getter();
 static char *stats_service_check_call();
 static char *stats_service_state_call();
 static void lock_stats();
@@ -310,19 +607,13 @@ static int initialize_stats_system(int interval_sec) {
 
     lock_stats();
     {
-        //Zero the cache location
-        bzero(message_stats_cache, MESSAGE_STATS_MEMORY_REGION_SIZE);
-
         //Init the message sensor with component-specific data
-        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_getter, message_stats_setter);
+        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_getter);
         if(ret != EUCA_OK) {
             LOGERROR("Error initializing internal message sensor: %d\n", ret);
             goto cleanup;
         } else {
-            json_object **tmp = message_stats_getter();
-            const char *tmp_out = json_object_to_json_string(*tmp);
-            LOGINFO("Initialized internal message stats: %s\n", tmp_out);
-            
+            LOGINFO("Initialized internal message stats\n");
         }
         
         //Init the service state sensor with component-specific data
@@ -331,6 +622,15 @@ static int initialize_stats_system(int interval_sec) {
             LOGERROR("Error initializing internal service state sensor: %d\n", ret);
             goto cleanup;
         }
+
+#ifdef EUCA_ALLOC_TRACKING
+        //Init the allocation sensor, which reports on the counters of the EUCA_ALLOC() call sites and the slabs
+        ret = initialize_alloc_sensor(euca_this_component_name, interval_sec, stats_ttl);
+        if(ret != EUCA_OK) {
+            LOGERROR("Error initializing internal allocation sensor: %d\n", ret);
+            goto cleanup;
+        }
+#endif /* EUCA_ALLOC_TRACKING */
         
         ret = init_stats(config->eucahome, euca_this_component_name, lock_stats, unlock_stats);
         if(ret != EUCA_OK) {
@@ -375,11 +675,11 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
     char internalObjectStorageURL[EUCA_MAX_PATH], theObjectStorageURL[EUCA_MAX_PATH];
     ccInstance *myInstance;
     time_t op_start;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     i = j = 0;
     myInstance = NULL;
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -409,10 +709,6 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
         strncpy(theObjectStorageURL, objectStorageURL, strlen(objectStorageURL) + 1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
         // found the instance in the cache
@@ -423,13 +719,17 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (j = start; j < stop && !done; j++) {
+        if (get_resourceCacheEntry(j, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, stop - start, j);
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[j].lockidx, resourceCacheLocal.resources[j].ncURL, "ncBundleInstance",
+        rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_BUNDLE_INSTANCE,
                           instanceId, bucketName, filePrefix, theObjectStorageURL, userPublicKey, S3Policy, S3PolicySig, architecture);
         if (rc) {
             ret = 1;
@@ -468,8 +768,8 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
     int timeout = 0;
     int done = 0;
     ccInstance *myInstance = NULL;
-    time_t op_start = time(NULL);
-    ccResourceCache resourceCacheLocal;
+    time_t op_start = mono_time_sec();
+    ccResource resourceLocal = { {0} };
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled())
@@ -482,12 +782,6 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
-
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
         if (myInstance) {
@@ -498,13 +792,17 @@ int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId)
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (j = start; ((j < stop) && !done); j++) {
+        if (get_resourceCacheEntry(j, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, (stop - start), j);
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[j].lockidx, resourceCacheLocal.resources[j].ncURL, "ncBundleRestartInstance", instanceId);
+        rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_BUNDLE_RESTART_INSTANCE, instanceId);
         if (rc) {
             ret = 1;
         } else {
@@ -535,11 +833,11 @@ int doCancelBundleTask(ncMetadata * pMeta, char *instanceId)
     int i, rc, start = 0, stop = 0, ret = 0, done, timeout;
     ccInstance *myInstance;
     time_t op_start;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     i = 0;
     myInstance = NULL;
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -552,10 +850,6 @@ int doCancelBundleTask(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
         // found the instance in the cache
@@ -566,13 +860,17 @@ int doCancelBundleTask(ncMetadata * pMeta, char *instanceId)
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (i = start; i < stop && !done; i++) {
+        if (get_resourceCacheEntry(i, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, stop - start, i);
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[i].lockidx, resourceCacheLocal.resources[i].ncURL, "ncCancelBundleTask", instanceId);
+        rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_CANCEL_BUNDLE_TASK, instanceId);
         if (rc) {
             ret = 1;
         } else {
@@ -620,800 +918,1248 @@ void filter_services(ncMetadata * meta, char *filter_partition)
 }
 
 //!
+//! Finds (or creates) the pooled NC stub for the given node URL and arms it with the
+//! given call timeout. WS-Security is applied once, when the stub is created. A stub
+//! which was inherited from a parent process is never reused since the parent still
+//! owns the underlying connection.
 //!
+//! @param[in] ncURL the URL of the node controller
+//! @param[in] timeout the timeout, in seconds, for the upcoming call
 //!
-//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
-//! @param[in] timeout
-//! @param[in] ncLock
-//! @param[in] ncURL
-//! @param[in] ncOp
-//! @param[in] ...
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return the pool slot holding a usable stub or -1 if none could be set up, in which
+//!         case the caller should fall back to the fork()ing client call
 //!
-int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, ...)
-{
-#define WRITE_REPLY_STRING                                                                \
-{                                                                                         \
-    if (timeout) {                                                                        \
-        int __len = 0;                                                                    \
-        if (localmeta->replyString) {                                                     \
-            __len = strlen(localmeta->replyString);                                       \
-        }                                                                                 \
-        int __bytes = write(filedes[1], &__len, sizeof(int));                             \
-        if (__len > 0) {                                                                  \
-            __bytes += write(filedes[1], localmeta->replyString, (sizeof(char) * __len)); \
-        }                                                                                 \
-        LOGTRACE("child process wrote %d bytes (len=%d)\n", __bytes, __len);              \
-    }                                                                                     \
-}
-
-#define READ_REPLY_STRING                                                      \
-{                                                                              \
-    if (timeout) {                                                             \
-        int __len = 0;                                                         \
-        rbytes = timeread(filedes[0], &__len, sizeof(int), timeout);           \
-        LOGTRACE("parent process read %d bytes (len=%d)\n", rbytes, __len);    \
-        if (rbytes <= 0) {                                                     \
-            killwait(pid);                                                     \
-            opFail = 1;                                                        \
-        } else if (__len > 0) {                                                \
-            pMeta->replyString = EUCA_ALLOC(__len, sizeof(char));              \
-            if (pMeta->replyString == NULL) {                                  \
-                LOGFATAL("out of memory! ncOps=%s\n", ncOp);                   \
-                unlock_exit(1);                                                \
-            }                                                                  \
-            rbytes = timeread(filedes[0], pMeta->replyString, __len, timeout); \
-            if (rbytes <= 0) {                                                 \
-                killwait(pid);                                                 \
-                opFail = 1;                                                    \
-            }                                                                  \
-        }                                                                      \
-    }                                                                          \
-}
-
+static int ncStubPoolAcquire(char *ncURL, int timeout)
+{
     int i = 0;
-    int pid = 0;
-    int rc = 0;
-    int ret = 0;
-    int status = 0;
-    int opFail = 0;
-    int len = 0;
-    int rbytes = 0;
-    int filedes[2] = { 0 };
-    va_list al = { {0} };
-
-    LOGTRACE("invoked: ncOps=%s ncURL=%s timeout=%d\n", ncOp, ncURL, timeout);  // these are common
-
-    if ((rc = pipe(filedes)) != 0) {
-        LOGERROR("cannot create pipe ncOps=%s\n", ncOp);
-        return (1);
-    }
+    int slot = -1;
+    pid_t self = getpid();
 
-    va_start(al, ncOp);
-
-    // grab the lock
-    sem_mywait(ncLock);
-
-    if ((pid = fork()) == 0) {
-        ncStub *ncs;
-        ncMetadata *localmeta = NULL;
-
-        LOGTRACE("forked to service NC invocation: %s\n", ncOp);
-        localmeta = EUCA_ZALLOC(1, sizeof(ncMetadata));
-        if (!localmeta) {
-            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-            unlock_exit(1);
-        }
-        memcpy(localmeta, pMeta, sizeof(ncMetadata));
-        if (pMeta->correlationId) {
-            localmeta->correlationId = strdup(pMeta->correlationId);
-        } else {
-            localmeta->correlationId = strdup("unset");
-        }
-        if (pMeta->userId) {
-            localmeta->userId = strdup(pMeta->userId);
-        } else {
-            localmeta->userId = strdup("eucalyptus");
-        }
-
-        //TODO: zhill, change this to only be invoked on DescribeInstances and/or DescribeResources?
-        //Update meta from config
-        if (populateOutboundMeta(localmeta)) {
-            LOGERROR("Failed to update output service metadata\n");
-        }
-        //Don't need to filter, CC should only have received.
-        //filter_services(localmeta, config->ccStatus.serviceId.partition);
+    if (!ncURL || (ncURL[0] == '\0') || (timeout <= 0))
+        return (-1);
 
-        close(filedes[0]);
-        ncs = ncStubCreate(ncURL, NULL, NULL);
-        if (config->use_wssec) {
-            rc = InitWSSEC(ncs->env, ncs->stub, config->policyFile);
+    for (i = 0; i < MAXNODES; i++) {
+        if (ncStubPool[i].ncURL[0] == '\0') {
+            if (slot < 0)
+                slot = i;
+        } else if (!strcmp(ncStubPool[i].ncURL, ncURL)) {
+            slot = i;
+            break;
         }
+    }
 
-        LOGTRACE("\tncOps=%s ppid=%d client calling '%s'\n", ncOp, getppid(), ncOp);
-        if (!strcmp(ncOp, "ncGetConsoleOutput")) {
-            // args: char *instId
-            char *instId = va_arg(al, char *);
-            char **consoleOutput = va_arg(al, char **);
-
-            rc = ncGetConsoleOutputStub(ncs, localmeta, instId, consoleOutput);
-            if (timeout && consoleOutput) {
-                if (!rc && *consoleOutput) {
-                    len = strlen(*consoleOutput) + 1;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *consoleOutput, sizeof(char) * len);
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-        } else if (!strcmp(ncOp, "ncAttachVolume")) {
-            char *instanceId = va_arg(al, char *);
-            char *volumeId = va_arg(al, char *);
-            char *remoteDev = va_arg(al, char *);
-            char *localDev = va_arg(al, char *);
-
-            rc = ncAttachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev);
-        } else if (!strcmp(ncOp, "ncDetachVolume")) {
-            char *instanceId = va_arg(al, char *);
-            char *volumeId = va_arg(al, char *);
-            char *remoteDev = va_arg(al, char *);
-            char *localDev = va_arg(al, char *);
-            int force = va_arg(al, int);
-
-            rc = ncDetachVolumeStub(ncs, localmeta, instanceId, volumeId, remoteDev, localDev, force);
-        } else if (!strcmp(ncOp, "ncCreateImage")) {
-            char *instanceId = va_arg(al, char *);
-            char *volumeId = va_arg(al, char *);
-            char *remoteDev = va_arg(al, char *);
-
-            rc = ncCreateImageStub(ncs, localmeta, instanceId, volumeId, remoteDev);
-        } else if (!strcmp(ncOp, "ncPowerDown")) {
-            rc = ncPowerDownStub(ncs, localmeta);
-        } else if (!strcmp(ncOp, "ncAssignAddress")) {
-            char *instanceId = va_arg(al, char *);
-            char *publicIp = va_arg(al, char *);
-
-            rc = ncAssignAddressStub(ncs, localmeta, instanceId, publicIp);
-        } else if (!strcmp(ncOp, "ncBroadcastNetworkInfo")) {
-            char *networkInfo = va_arg(al, char *);
-            rc = ncBroadcastNetworkInfoStub(ncs, localmeta, networkInfo);
-        } else if (!strcmp(ncOp, "ncRebootInstance")) {
-            char *instId = va_arg(al, char *);
-
-            rc = ncRebootInstanceStub(ncs, localmeta, instId);
-        } else if (!strcmp(ncOp, "ncTerminateInstance")) {
-            char *instId = va_arg(al, char *);
-            int force = va_arg(al, int);
-            int *shutdownState = va_arg(al, int *);
-            int *previousState = va_arg(al, int *);
-
-            rc = ncTerminateInstanceStub(ncs, localmeta, instId, force, shutdownState, previousState);
-
-            if (timeout) {
-                if (!rc) {
-                    len = 2;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], shutdownState, sizeof(int));
-                    rc = write(filedes[1], previousState, sizeof(int));
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-        } else if (!strcmp(ncOp, "ncStartNetwork")) {   //! @TODO remove this NC call logic, since it is not used any more
-            char *uuid = va_arg(al, char *);
-            char **peers = va_arg(al, char **);
-            int peersLen = va_arg(al, int);
-            int port = va_arg(al, int);
-            int vlan = va_arg(al, int);
-            char **outStatus = va_arg(al, char **);
-
-            rc = ncStartNetworkStub(ncs, localmeta, uuid, peers, peersLen, port, vlan, outStatus);
-            if (timeout && outStatus) {
-                if (!rc && *outStatus) {
-                    len = strlen(*outStatus) + 1;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *outStatus, sizeof(char) * len);
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-
-            if (outStatus)
-                EUCA_FREE(*outStatus);
-        } else if (!strcmp(ncOp, "ncRunInstance")) {
-            char *uuid = va_arg(al, char *);
-            char *instId = va_arg(al, char *);
-            char *reservationId = va_arg(al, char *);
-            virtualMachine *ncvm = va_arg(al, virtualMachine *);
-            char *imageId = va_arg(al, char *);
-            char *imageURL = va_arg(al, char *);
-            char *kernelId = va_arg(al, char *);
-            char *kernelURL = va_arg(al, char *);
-            char *ramdiskId = va_arg(al, char *);
-            char *ramdiskURL = va_arg(al, char *);
-            char *ownerId = va_arg(al, char *);
-            char *accountId = va_arg(al, char *);
-            char *keyName = va_arg(al, char *);
-            netConfig *ncnet = va_arg(al, netConfig *);
-            char *userData = va_arg(al, char *);
-            char *credential = va_arg(al, char *);
-            char *launchIndex = va_arg(al, char *);
-            char *platform = va_arg(al, char *);
-            int expiryTime = va_arg(al, int);
-            char **netNames = va_arg(al, char **);
-            int netNamesLen = va_arg(al, int);
-            char *rootDirective = va_arg(al, char *);
-            ncInstance **outInst = va_arg(al, ncInstance **);
-
-            rc = ncRunInstanceStub(ncs, localmeta, uuid, instId, reservationId, ncvm, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL,
-                                   ownerId, accountId, keyName, ncnet, userData, credential, launchIndex, platform, expiryTime, netNames, netNamesLen, rootDirective, outInst);
-            if (timeout && outInst) {
-                if (!rc && *outInst) {
-                    len = sizeof(ncInstance);
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *outInst, sizeof(ncInstance));
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-
-            if (outInst)
-                EUCA_FREE(*outInst);
-        } else if (!strcmp(ncOp, "ncDescribeInstances")) {
-            char **instIds = va_arg(al, char **);
-            int instIdsLen = va_arg(al, int);
-            ncInstance ***ncOutInsts = va_arg(al, ncInstance ***);
-            int *ncOutInstsLen = va_arg(al, int *);
-
-            rc = ncDescribeInstancesStub(ncs, localmeta, instIds, instIdsLen, ncOutInsts, ncOutInstsLen);
-            if (timeout && ncOutInsts && ncOutInstsLen) {
-                if (!rc) {
-                    len = *ncOutInstsLen;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    for (i = 0; i < len; i++) {
-                        ncInstance *inst;
-                        inst = (*ncOutInsts)[i];
-                        rc = write(filedes[1], inst, sizeof(ncInstance));
-                    }
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-
-            if (ncOutInsts) {
-                if (ncOutInstsLen) {
-                    for (i = 0; i < (*ncOutInstsLen); i++) {
-                        EUCA_FREE((*ncOutInsts)[i]);
-                    }
-                }
-                EUCA_FREE(*ncOutInsts);
-            }
-        } else if (!strcmp(ncOp, "ncDescribeResource")) {
-            char *resourceType = va_arg(al, char *);
-            ncResource **outRes = va_arg(al, ncResource **);
-            char **errMsg = va_arg(al, char **);
-
-            LOGTRACE("\tcalling ncDescribeResourceStub with resourceType=%s outRes=%lx errMsg=%lx\n", resourceType, (unsigned long)outRes, (unsigned long)errMsg);
-            rc = ncDescribeResourceStub(ncs, localmeta, resourceType, outRes);
-            LOGTRACE("\tcalled  ncDescribeResourceStub, rc = %d, timeout = %d\n", rc, timeout);
-            if (timeout && outRes) {
-                if (!rc && *outRes) {
-                    len = sizeof(ncResource);
-                    rc = write(filedes[1], &rc, sizeof(int));   //NOTE: we write back rc as well
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = write(filedes[1], *outRes, sizeof(ncResource));
-                    rc = 0;
-                } else {
-                    (*errMsg) = (char *)axutil_error_get_message(ncs->env->error);
-                    LOGTRACE("\terrMsg = %s\n", *errMsg);
-                    if (*errMsg && (len = strnlen(*errMsg, 1024 - 1))) {
-                        len += 1;
-                        rc = write(filedes[1], &rc, sizeof(int));   //NOTE: we write back rc as well
-                        rc = write(filedes[1], &len, sizeof(int));
-                        rc = write(filedes[1], *errMsg, sizeof(char) * len);
-                    } else {
-                        len = 0;
-                        rc = write(filedes[1], &rc, sizeof(int));   //NOTE: we write back rc as well
-                        rc = write(filedes[1], &len, sizeof(int));
-                    }
-                    rc = 1;
-                }
-            }
-
-            if (outRes)
-                EUCA_FREE(*outRes);
-        } else if (!strcmp(ncOp, "ncDescribeSensors")) {
-            int history_size = va_arg(al, int);
-            long long collection_interval_time_ms = va_arg(al, long long);
-            char **instIds = va_arg(al, char **);
-            int instIdsLen = va_arg(al, int);
-            char **sensorIds = va_arg(al, char **);
-            int sensorIdsLen = va_arg(al, int);
-            sensorResource ***srs = va_arg(al, sensorResource ***);
-            int *srsLen = va_arg(al, int *);
-
-            rc = ncDescribeSensorsStub(ncs, localmeta, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen, srs, srsLen);
-            if (timeout && srs && srsLen) {
-                if (!rc) {
-                    len = *srsLen;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    for (i = 0; i < len; i++) {
-                        sensorResource *sr;
-                        sr = (*srs)[i];
-                        rc = write(filedes[1], sr, sizeof(sensorResource));
-                    }
-                    rc = 0;
-                } else {
-                    len = 0;
-                    rc = write(filedes[1], &len, sizeof(int));
-                    rc = 1;
-                }
-            }
-
-            if (srs) {
-                if (srsLen) {
-                    for (i = 0; i < (*srsLen); i++) {
-                        EUCA_FREE((*srs)[i]);
-                    }
-                }
-                EUCA_FREE(*srs);
-            }
-        } else if (!strcmp(ncOp, "ncBundleInstance")) {
-            char *instanceId = va_arg(al, char *);
-            char *bucketName = va_arg(al, char *);
-            char *filePrefix = va_arg(al, char *);
-            char *objectStorageURL = va_arg(al, char *);
-            char *userPublicKey = va_arg(al, char *);
-            char *S3Policy = va_arg(al, char *);
-            char *S3PolicySig = va_arg(al, char *);
-            char *architecture = va_arg(al, char *);
-
-            rc = ncBundleInstanceStub(ncs, localmeta, instanceId, bucketName, filePrefix, objectStorageURL, userPublicKey, S3Policy, S3PolicySig, architecture);
-        } else if (!strcmp(ncOp, "ncBundleRestartInstance")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncBundleRestartInstanceStub(ncs, localmeta, instanceId);
-        } else if (!strcmp(ncOp, "ncCancelBundleTask")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncCancelBundleTaskStub(ncs, localmeta, instanceId);
-        } else if (!strcmp(ncOp, "ncModifyNode")) {
-            char *stateName = va_arg(al, char *);
-            rc = ncModifyNodeStub(ncs, localmeta, stateName);
-        } else if (!strcmp(ncOp, "ncMigrateInstances")) {
-            ncInstance **instances = va_arg(al, ncInstance **);
-            int instancesLen = va_arg(al, int);
-            char *action = va_arg(al, char *);
-            char *credentials = va_arg(al, char *);
-            rc = ncMigrateInstancesStub(ncs, localmeta, instances, instancesLen, action, credentials);
-            WRITE_REPLY_STRING;
-        } else if (!strcmp(ncOp, "ncStartInstance")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncStartInstanceStub(ncs, localmeta, instanceId);
-            WRITE_REPLY_STRING;
-        } else if (!strcmp(ncOp, "ncStopInstance")) {
-            char *instanceId = va_arg(al, char *);
-            rc = ncStopInstanceStub(ncs, localmeta, instanceId);
-            WRITE_REPLY_STRING;
-        } else {
-            LOGWARN("\tncOps=%s ppid=%d operation '%s' not found\n", ncOp, getppid(), ncOp);
-            rc = 1;
-        }
-        LOGTRACE("\tncOps=%s ppid=%d done calling '%s' with exit code '%d'\n", ncOp, getppid(), ncOp, rc);
-        if (localmeta->replyString != NULL) {
-            LOGDEBUG("NC replied to '%s' with '%s'\n", ncOp, localmeta->replyString);
-        }
-        if (rc) {
-            ret = 1;
-        } else {
-            ret = 0;
-        }
-        close(filedes[1]);
+    if (slot < 0) {
+        LOGDEBUG("NC stub pool is full, not pooling ncURL=%s\n", ncURL);
+        return (-1);
+    }
 
-        // Free our local meta data structure and associated memory
-        EUCA_FREE(localmeta->replyString);
-        EUCA_FREE(localmeta->correlationId);
-        EUCA_FREE(localmeta->userId);
-        EUCA_FREE(localmeta);
+    if (ncStubPool[slot].stub && (ncStubPool[slot].owner != self)) {
+        // do not destroy it, the memory is only a copy of our parent's stub
+        ncStubPool[slot].stub = NULL;
+    }
 
-        // ditch our stub
-        if (ncs != NULL) {
-            ncStubDestroy(ncs);
-            ncs = NULL;
+    if (ncStubPool[slot].stub == NULL) {
+        if ((ncStubPool[slot].stub = ncStubCreate(ncURL, NULL, NULL)) == NULL) {
+            LOGERROR("failed to create NC stub for ncURL=%s\n", ncURL);
+            ncStubPool[slot].ncURL[0] = '\0';
+            return (-1);
         }
-        exit(ret);
-    } else {
-        // returns for each client call
-        close(filedes[1]);
 
-        if (!strcmp(ncOp, "ncGetConsoleOutput")) {
-            char *instId = NULL;
-            char **outConsoleOutput = NULL;
-
-            instId = va_arg(al, char *);
-            outConsoleOutput = va_arg(al, char **);
-            if (outConsoleOutput) {
-                *outConsoleOutput = NULL;
-            }
-            if (timeout && outConsoleOutput) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
-                if (rbytes <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else {
-                    *outConsoleOutput = EUCA_ALLOC(len, sizeof(char));
-                    if (!*outConsoleOutput) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    rbytes = timeread(filedes[0], *outConsoleOutput, len, timeout);
-                    if (rbytes <= 0) {
-                        killwait(pid);
-                        opFail = 1;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncTerminateInstance")) {
-            char *instId = NULL;
-            int force = 0;
-            int *shutdownState = NULL;
-            int *previousState = NULL;
-
-            instId = va_arg(al, char *);
-            force = va_arg(al, int);
-            shutdownState = va_arg(al, int *);
-            previousState = va_arg(al, int *);
-            if (shutdownState && previousState) {
-                *shutdownState = *previousState = 0;
-            }
-            if (timeout && shutdownState && previousState) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
-                if (rbytes <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else {
-                    rbytes = timeread(filedes[0], shutdownState, sizeof(int), timeout);
-                    if (rbytes <= 0) {
-                        killwait(pid);
-                        opFail = 1;
-                    }
-                    rbytes = timeread(filedes[0], previousState, sizeof(int), timeout);
-                    if (rbytes <= 0) {
-                        killwait(pid);
-                        opFail = 1;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncStartNetwork")) {   //! @TODO remove this NC call logic, since it is not used any more
-            char *uuid = NULL;
-            char **peers = NULL;
-            int peersLen = 0;
-            int port = 0;
-            int vlan = 0;
-            char **outStatus = NULL;
-
-            uuid = va_arg(al, char *);
-            peers = va_arg(al, char **);
-            peersLen = va_arg(al, int);
-            port = va_arg(al, int);
-            vlan = va_arg(al, int);
-            outStatus = va_arg(al, char **);
-            if (outStatus) {
-                *outStatus = NULL;
-            }
-            if (timeout && outStatus) {
-                *outStatus = NULL;
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
-                if (rbytes <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else {
-                    *outStatus = EUCA_ALLOC(len, sizeof(char));
-                    if (!*outStatus) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    rbytes = timeread(filedes[0], *outStatus, len, timeout);
-                    if (rbytes <= 0) {
-                        killwait(pid);
-                        opFail = 1;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncRunInstance")) {
-            char *uuid = NULL;
-            char *instId = NULL;
-            char *reservationId = NULL;
-            virtualMachine *ncvm = NULL;
-            char *imageId = NULL;
-            char *imageURL = NULL;
-            char *kernelId = NULL;
-            char *kernelURL = NULL;
-            char *ramdiskId = NULL;
-            char *ramdiskURL = NULL;
-            char *ownerId = NULL;
-            char *accountId = NULL;
-            char *keyName = NULL;
-            netConfig *ncnet = NULL;
-            char *userData = NULL;
-            char *credential = NULL;
-            char *launchIndex = NULL;
-            char *platform = NULL;
-            int expiryTime = 0;
-            char **netNames = NULL;
-            int netNamesLen = 0;
-            char *rootDirective = NULL;
-            ncInstance **outInst = NULL;
-
-            uuid = va_arg(al, char *);
-            instId = va_arg(al, char *);
-            reservationId = va_arg(al, char *);
-            ncvm = va_arg(al, virtualMachine *);
-            imageId = va_arg(al, char *);
-            imageURL = va_arg(al, char *);
-            kernelId = va_arg(al, char *);
-            kernelURL = va_arg(al, char *);
-            ramdiskId = va_arg(al, char *);
-            ramdiskURL = va_arg(al, char *);
-            ownerId = va_arg(al, char *);
-            accountId = va_arg(al, char *);
-            keyName = va_arg(al, char *);
-            ncnet = va_arg(al, netConfig *);
-            userData = va_arg(al, char *);
-            credential = va_arg(al, char *);
-            launchIndex = va_arg(al, char *);
-            platform = va_arg(al, char *);
-            expiryTime = va_arg(al, int);
-            netNames = va_arg(al, char **);
-            netNamesLen = va_arg(al, int);
-            rootDirective = va_arg(al, char *);
-            outInst = va_arg(al, ncInstance **);
-            if (outInst) {
-                *outInst = NULL;
-            }
-            if (timeout && outInst) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
-                if (rbytes <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else {
-                    *outInst = EUCA_ZALLOC(1, sizeof(ncInstance));
-                    if (!*outInst) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    rbytes = timeread(filedes[0], *outInst, sizeof(ncInstance), timeout);
-                    if (rbytes <= 0) {
-                        killwait(pid);
-                        opFail = 1;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncDescribeInstances")) {
-            char **instIds = NULL;
-            int instIdsLen = 0;
-            ncInstance ***ncOutInsts = NULL;
-            int *ncOutInstsLen = NULL;
-
-            instIds = va_arg(al, char **);
-            instIdsLen = va_arg(al, int);
-            ncOutInsts = va_arg(al, ncInstance ***);
-            ncOutInstsLen = va_arg(al, int *);
-            if (ncOutInstsLen && ncOutInsts) {
-                *ncOutInstsLen = 0;
-                *ncOutInsts = NULL;
-            }
-            if (timeout && ncOutInsts && ncOutInstsLen) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
-                if (rbytes <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else {
-                    *ncOutInsts = EUCA_ZALLOC(len, sizeof(ncInstance *));
-                    if (!*ncOutInsts) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    *ncOutInstsLen = len;
-                    for (i = 0; i < len; i++) {
-                        ncInstance *inst;
-                        inst = EUCA_ZALLOC(1, sizeof(ncInstance));
-                        if (!inst) {
-                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                            unlock_exit(1);
-                        }
-                        rbytes = timeread(filedes[0], inst, sizeof(ncInstance), timeout);
-                        (*ncOutInsts)[i] = inst;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncDescribeResource")) {
-            char *resourceType = NULL;
-            char **errMsg = NULL;
-            ncResource **outRes = NULL;
-
-            resourceType = va_arg(al, char *);
-            outRes = va_arg(al, ncResource **);
-            errMsg = va_arg(al, char **);
-            if (outRes) {
-                *outRes = NULL;
-            }
-            if (timeout && outRes) {
-                // first int we read back is the 'rc', then the 'len'
-                rbytes = timeread(filedes[0], &opFail, sizeof(int), timeout);
-                if (rbytes <= 0 || (rbytes = timeread(filedes[0], &len, sizeof(int), timeout)) <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else if (opFail && len) {
-                    *errMsg = EUCA_ZALLOC(len, sizeof(char));
-                    if (*errMsg == NULL) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    rbytes = timeread(filedes[0], *errMsg, len * sizeof(char), timeout);
-                    if (rbytes <= 0 || opFail) {
-                        kill(pid, SIGKILL);
-                        opFail = 1;
-                    }
-                } else {
-                    *outRes = EUCA_ZALLOC(1, sizeof(ncResource));
-                    if (*outRes == NULL) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    rbytes = timeread(filedes[0], *outRes, sizeof(ncResource), timeout);
-                    if (rbytes <= 0) {
-                        killwait(pid);
-                        opFail = 1;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncDescribeSensors")) {
-            int history_size = 0;
-            long long collection_interval_time_ms = 0L;
-            char **instIds = NULL;
-            int instIdsLen = 0;
-            char **sensorIds = NULL;
-            int sensorIdsLen = 0;
-            sensorResource ***srs = NULL;
-            int *srsLen = NULL;
-
-            history_size = va_arg(al, int);
-            collection_interval_time_ms = va_arg(al, long long);
-            instIds = va_arg(al, char **);
-            instIdsLen = va_arg(al, int);
-            sensorIds = va_arg(al, char **);
-            sensorIdsLen = va_arg(al, int);
-            srs = va_arg(al, sensorResource ***);
-            srsLen = va_arg(al, int *);
-
-            if (srs && srsLen) {
-                *srs = NULL;
-                *srsLen = 0;
-            }
-            if (timeout && srs && srsLen) {
-                rbytes = timeread(filedes[0], &len, sizeof(int), timeout);
-                if (rbytes <= 0) {
-                    killwait(pid);
-                    opFail = 1;
-                } else {
-                    *srs = EUCA_ZALLOC(len, sizeof(sensorResource *));
-                    if (*srs == NULL) {
-                        LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                        unlock_exit(1);
-                    }
-                    *srsLen = len;
-                    for (i = 0; i < len; i++) {
-                        sensorResource *sr;
-                        sr = EUCA_ZALLOC(1, sizeof(sensorResource));
-                        if (sr == NULL) {
-                            LOGFATAL("out of memory! ncOps=%s\n", ncOp);
-                            unlock_exit(1);
-                        }
-                        rbytes = timeread(filedes[0], sr, sizeof(sensorResource), timeout);
-                        (*srs)[i] = sr;
-                    }
-                }
-            }
-        } else if (!strcmp(ncOp, "ncMigrateInstances")) {
-            READ_REPLY_STRING;
-        } else if (!strcmp(ncOp, "ncStartInstance")) {
-            READ_REPLY_STRING;
-        } else if (!strcmp(ncOp, "ncStopInstance")) {
-            READ_REPLY_STRING;
-        } else {
-            // nothing to do in default case (succ/fail encoded in exit code)
+        if (config->use_wssec && InitWSSEC(ncStubPool[slot].stub->env, ncStubPool[slot].stub->stub, config->policyFile)) {
+            LOGERROR("failed to initialize WS-Security on NC stub for ncURL=%s\n", ncURL);
+            ncStubDestroy(ncStubPool[slot].stub);
+            ncStubPool[slot].stub = NULL;
+            ncStubPool[slot].ncURL[0] = '\0';
+            return (-1);
         }
 
-        close(filedes[0]);
-        if (timeout) {
-            rc = timewait(pid, &status, timeout);
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                int sig = -1;
-                int dump = 0;
-                if (WIFSIGNALED(status)) {
-                    sig = WTERMSIG(status);
-                    dump = WCOREDUMP(status);
-                }
-                if (sig == SIGTERM || sig == SIGKILL) { // our killwait() first tries SIGTERM and then SIGKILL
-                    LOGDEBUG("child process %d handling '%s' was terminated with %d\n", pid, ncOp, sig);
-                } else {
-                    LOGERROR("BUG: child process %d handling '%s' was terminated with %d (core=%d)\n", pid, ncOp, sig, dump);
-                }
-                rc = 1;
-            }
-        } else {
-            rc = 0;
-        }
+        euca_strncpy(ncStubPool[slot].ncURL, ncURL, sizeof(ncStubPool[slot].ncURL));
+        ncStubPool[slot].owner = self;
+        ncStubPool[slot].calls = 0;
+        LOGTRACE("created pooled NC stub slot=%d ncURL=%s\n", slot, ncURL);
     }
 
-    LOGTRACE("done ncOps=%s clientrc=%d opFail=%d\n", ncOp, rc, opFail);
-    if (rc || opFail) {
-        ret = 1;
-    } else {
-        ret = 0;
+    if (ncStubSetTimeout(ncStubPool[slot].stub, timeout) != EUCA_OK) {
+        LOGWARN("failed to set a %d seconds timeout on NC stub for ncURL=%s\n", timeout, ncURL);
+        ncStubPoolRelease(slot, TRUE);
+        return (-1);
     }
 
-    // release the lock
-    sem_mypost(ncLock);
-
-    va_end(al);
+    ncStubPool[slot].calls++;
+    return (slot);
+}
 
-    return (ret);
+//!
+//! Hands a stub back to the pool once a call has completed. A stub is recycled after
+//! a failed call (the connection state is unknown), after NC_POOL_STUB_MAX_CALLS
+//! calls or once the arena backing its Axis2 environment, which only gives memory
+//! back when the stub is destroyed, holds more than NC_POOL_STUB_MAX_BYTES.
+//!
+//! @param[in] slot the pool slot returned by ncStubPoolAcquire()
+//! @param[in] failed set to TRUE if the call made through this stub failed
+//!
+static void ncStubPoolRelease(int slot, int failed)
+{
+    if ((slot < 0) || (slot >= MAXNODES) || (ncStubPool[slot].stub == NULL))
+        return;
 
-#undef WRITE_REPLY_STRING
-#undef READ_REPLY_STRING
+    if (failed || (ncStubPool[slot].calls >= NC_POOL_STUB_MAX_CALLS) || (euca_arena_bytes(ncStubPool[slot].stub->arena) > NC_POOL_STUB_MAX_BYTES)) {
+        LOGTRACE("recycling pooled NC stub slot=%d ncURL=%s calls=%d bytes=%lu failed=%d\n", slot, ncStubPool[slot].ncURL, ncStubPool[slot].calls,
+                 (unsigned long)euca_arena_bytes(ncStubPool[slot].stub->arena), failed);
+        ncStubDestroy(ncStubPool[slot].stub);
+        ncStubPool[slot].stub = NULL;
+        ncStubPool[slot].ncURL[0] = '\0';
+        ncStubPool[slot].calls = 0;
+    }
 }
 
 //!
-//! Calculate nc call timeout, based on when operation was started (op_start), the total
-//! number of calls to make (numCalls), and the current progress (idx)
+//! Receives a fixed-size part of the reply of a forked NC call
 //!
-//! @param[in] op_start
-//! @param[in] op_max
-//! @param[in] numCalls
-//! @param[in] idx
+//! @param[in]  fd read end of the pipe to the child
+//! @param[out] buf where to store the bytes
+//! @param[in]  len number of bytes to read
+//! @param[in]  timeout in seconds
 //!
-//! @return
+//! @return EUCA_OK on success or EUCA_IO_ERROR if the child did not send them in time
 //!
-//! @pre
+static int nc_reply_read(int fd, void *buf, size_t len, int timeout)
+{
+    return ((timeread(fd, buf, len, timeout) > 0) ? EUCA_OK : EUCA_IO_ERROR);
+}
+
 //!
-//! @note
+//! Sends a string, prefixed with its length including the terminator, from the child of a forked
+//! NC call. A length of 0 stands for no string.
 //!
-int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
+//! @param[in] fd write end of the pipe to the parent
+//! @param[in] s the string, may be NULL
+//!
+static void nc_reply_write_string(int fd, const char *s)
 {
-    time_t op_timer, op_pernode;
-    int numLeft;
+    int len = ((s != NULL) ? (strlen(s) + 1) : 0);
 
-    numLeft = numCalls - idx;
-    if (numLeft <= 0) {
-        numLeft = 1;
+    if ((write(fd, &len, sizeof(int)) == sizeof(int)) && (len > 0)) {
+        if (write(fd, s, len) != len) {
+            LOGTRACE("child process failed to write a %d bytes reply\n", len);
+        }
     }
-
-    op_timer = op_max - (time(NULL) - op_start);
-    op_pernode = op_timer / numLeft;
-
-    return (maxint(minint(op_pernode, OP_TIMEOUT_PERNODE), OP_TIMEOUT_MIN));
+}
+
+//!
+//! Receives a string sent with nc_reply_write_string()
+//!
+//! @param[in]  fd read end of the pipe to the child
+//! @param[out] s the string, left NULL if none was sent, which the caller frees
+//! @param[in]  timeout in seconds
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR if the child did not send it in time
+//!
+static int nc_reply_read_string(int fd, char **s, int timeout)
+{
+    int len = 0;
+
+    *s = NULL;
+    if (nc_reply_read(fd, &len, sizeof(int), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    if (len <= 0)
+        return (EUCA_OK);
+
+    if ((*s = EUCA_ZALLOC((len + 1), sizeof(char))) == NULL) {
+        LOGFATAL("out of memory! len=%d\n", len);
+        unlock_exit(1);
+    }
+    if (nc_reply_read(fd, *s, len, timeout) != EUCA_OK) {
+        EUCA_FREE(*s);
+        return (EUCA_IO_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Receives an array of structures sent as a count followed by the structures
+//!
+//! @param[in]  fd read end of the pipe to the child
+//! @param[out] array the allocated array of structures from the slab, which the caller frees
+//! @param[out] array_len number of structures received
+//! @param[in]  slab the slab of the structures
+//! @param[in]  timeout in seconds
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR if the child did not send them in time
+//!
+static int nc_reply_read_array(int fd, void ***array, int *array_len, euca_slab * slab, int timeout)
+{
+    int i = 0;
+    int len = 0;
+
+    if (nc_reply_read(fd, &len, sizeof(int), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    if (len <= 0)
+        return (EUCA_OK);
+
+    if ((*array = EUCA_ZALLOC(len, sizeof(void *))) == NULL) {
+        LOGFATAL("out of memory! len=%d\n", len);
+        unlock_exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        if (((*array)[i] = EUCA_SLAB_ZALLOC(slab)) == NULL) {
+            LOGFATAL("out of memory! len=%d\n", len);
+            unlock_exit(1);
+        }
+        (*array_len)++;
+        if (nc_reply_read(fd, (*array)[i], slab->size, timeout) != EUCA_OK)
+            return (EUCA_IO_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Frees an array of allocated structures
+//!
+//! @param[in,out] array the array, set to NULL
+//! @param[in,out] array_len number of structures in it, set to 0
+//!
+static void nc_free_array(void ***array, int *array_len)
+{
+    int i = 0;
+
+    if (*array) {
+        for (i = 0; i < (*array_len); i++) {
+            EUCA_FREE((*array)[i]);
+        }
+    }
+    EUCA_FREE(*array);
+    *array_len = 0;
+}
+
+//! @{
+//! @name the NC operations, see ncOperations[]
+
+static void nc_unpack_get_console_output(ncOpArgs * args, va_list * al)
+{
+    args->getConsoleOutput.instanceId = va_arg(*al, char *);
+    args->getConsoleOutput.consoleOutput = va_arg(*al, char **);
+}
+
+static int nc_call_get_console_output(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    char **consoleOutput = args->getConsoleOutput.consoleOutput;
+    int rc = ncGetConsoleOutputStub(ncs, meta, args->getConsoleOutput.instanceId, consoleOutput);
+
+    if (consoleOutput && (rc || !(*consoleOutput))) {
+        EUCA_FREE(*consoleOutput);
+        rc = 1;
+    }
+    return (rc);
+}
+
+static int nc_write_get_console_output(int fd, ncOpArgs * args, int rc)
+{
+    if (args->getConsoleOutput.consoleOutput)
+        nc_reply_write_string(fd, (rc ? NULL : *(args->getConsoleOutput.consoleOutput)));
+    return (rc);
+}
+
+static int nc_read_get_console_output(int fd, ncOpArgs * args, int timeout)
+{
+    char **consoleOutput = args->getConsoleOutput.consoleOutput;
+
+    if (consoleOutput == NULL)
+        return (EUCA_OK);
+    *consoleOutput = NULL;
+    if (!timeout)
+        return (EUCA_OK);
+    if (nc_reply_read_string(fd, consoleOutput, timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    return ((*consoleOutput) ? EUCA_OK : EUCA_ERROR);
+}
+
+static void nc_unpack_attach_volume(ncOpArgs * args, va_list * al)
+{
+    args->volume.instanceId = va_arg(*al, char *);
+    args->volume.volumeId = va_arg(*al, char *);
+    args->volume.remoteDev = va_arg(*al, char *);
+    args->volume.localDev = va_arg(*al, char *);
+}
+
+static int nc_call_attach_volume(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncAttachVolumeStub(ncs, meta, args->volume.instanceId, args->volume.volumeId, args->volume.remoteDev, args->volume.localDev));
+}
+
+static void nc_unpack_detach_volume(ncOpArgs * args, va_list * al)
+{
+    nc_unpack_attach_volume(args, al);
+    args->volume.force = va_arg(*al, int);
+}
+
+static int nc_call_detach_volume(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncDetachVolumeStub(ncs, meta, args->volume.instanceId, args->volume.volumeId, args->volume.remoteDev, args->volume.localDev, args->volume.force));
+}
+
+static void nc_unpack_create_image(ncOpArgs * args, va_list * al)
+{
+    args->volume.instanceId = va_arg(*al, char *);
+    args->volume.volumeId = va_arg(*al, char *);
+    args->volume.remoteDev = va_arg(*al, char *);
+}
+
+static int nc_call_create_image(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncCreateImageStub(ncs, meta, args->volume.instanceId, args->volume.volumeId, args->volume.remoteDev));
+}
+
+static void nc_unpack_none(ncOpArgs * args, va_list * al)
+{
+}
+
+static int nc_call_power_down(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncPowerDownStub(ncs, meta));
+}
+
+static void nc_unpack_assign_address(ncOpArgs * args, va_list * al)
+{
+    args->assignAddress.instanceId = va_arg(*al, char *);
+    args->assignAddress.publicIp = va_arg(*al, char *);
+}
+
+static int nc_call_assign_address(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncAssignAddressStub(ncs, meta, args->assignAddress.instanceId, args->assignAddress.publicIp));
+}
+
+//! Unpacks the single string argument of an operation (an instance ID, the network info or a node state)
+static void nc_unpack_string(ncOpArgs * args, va_list * al)
+{
+    args->string = va_arg(*al, char *);
+}
+
+static int nc_call_broadcast_network_info(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncBroadcastNetworkInfoStub(ncs, meta, args->string));
+}
+
+static int nc_call_reboot_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncRebootInstanceStub(ncs, meta, args->string));
+}
+
+static void nc_unpack_terminate_instance(ncOpArgs * args, va_list * al)
+{
+    args->terminateInstance.instanceId = va_arg(*al, char *);
+    args->terminateInstance.force = va_arg(*al, int);
+    args->terminateInstance.shutdownState = va_arg(*al, int *);
+    args->terminateInstance.previousState = va_arg(*al, int *);
+}
+
+static int nc_call_terminate_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    int *shutdownState = args->terminateInstance.shutdownState;
+    int *previousState = args->terminateInstance.previousState;
+    int rc = ncTerminateInstanceStub(ncs, meta, args->terminateInstance.instanceId, args->terminateInstance.force, shutdownState, previousState);
+
+    if (rc && shutdownState && previousState) {
+        *shutdownState = *previousState = 0;
+    }
+    return (rc);
+}
+
+static int nc_write_terminate_instance(int fd, ncOpArgs * args, int rc)
+{
+    int states[2] = { 0 };
+    int len = (rc ? 0 : 2);
+
+    if (!args->terminateInstance.shutdownState || !args->terminateInstance.previousState)
+        return (rc);
+
+    states[0] = *(args->terminateInstance.shutdownState);
+    states[1] = *(args->terminateInstance.previousState);
+    if ((write(fd, &len, sizeof(int)) != sizeof(int)) || ((len > 0) && (write(fd, states, sizeof(states)) != sizeof(states))))
+        return (1);
+    return (rc);
+}
+
+static int nc_read_terminate_instance(int fd, ncOpArgs * args, int timeout)
+{
+    int len = 0;
+    int states[2] = { 0 };
+    int *shutdownState = args->terminateInstance.shutdownState;
+    int *previousState = args->terminateInstance.previousState;
+
+    if (!shutdownState || !previousState)
+        return (EUCA_OK);
+    *shutdownState = *previousState = 0;
+    if (!timeout)
+        return (EUCA_OK);
+
+    if (nc_reply_read(fd, &len, sizeof(int), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    if (len != 2)
+        return (EUCA_ERROR);
+    if (nc_reply_read(fd, states, sizeof(states), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    *shutdownState = states[0];
+    *previousState = states[1];
+    return (EUCA_OK);
+}
+
+//! @TODO remove the ncStartNetwork operation, since it is not used any more
+static void nc_unpack_start_network(ncOpArgs * args, va_list * al)
+{
+    args->startNetwork.uuid = va_arg(*al, char *);
+    args->startNetwork.peers = va_arg(*al, char **);
+    args->startNetwork.peersLen = va_arg(*al, int);
+    args->startNetwork.port = va_arg(*al, int);
+    args->startNetwork.vlan = va_arg(*al, int);
+    args->startNetwork.outStatus = va_arg(*al, char **);
+}
+
+static int nc_call_start_network(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    char **outStatus = args->startNetwork.outStatus;
+    int rc = ncStartNetworkStub(ncs, meta, args->startNetwork.uuid, args->startNetwork.peers, args->startNetwork.peersLen, args->startNetwork.port,
+                                args->startNetwork.vlan, outStatus);
+
+    if (outStatus && (rc || !(*outStatus))) {
+        EUCA_FREE(*outStatus);
+        rc = 1;
+    }
+    return (rc);
+}
+
+static int nc_write_start_network(int fd, ncOpArgs * args, int rc)
+{
+    if (args->startNetwork.outStatus)
+        nc_reply_write_string(fd, (rc ? NULL : *(args->startNetwork.outStatus)));
+    return (rc);
+}
+
+static int nc_read_start_network(int fd, ncOpArgs * args, int timeout)
+{
+    char **outStatus = args->startNetwork.outStatus;
+
+    if (outStatus == NULL)
+        return (EUCA_OK);
+    *outStatus = NULL;
+    if (!timeout)
+        return (EUCA_OK);
+    if (nc_reply_read_string(fd, outStatus, timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    return ((*outStatus) ? EUCA_OK : EUCA_ERROR);
+}
+
+static void nc_unpack_run_instance(ncOpArgs * args, va_list * al)
+{
+    args->runInstance.uuid = va_arg(*al, char *);
+    args->runInstance.instanceId = va_arg(*al, char *);
+    args->runInstance.reservationId = va_arg(*al, char *);
+    args->runInstance.ncvm = va_arg(*al, virtualMachine *);
+    args->runInstance.imageId = va_arg(*al, char *);
+    args->runInstance.imageURL = va_arg(*al, char *);
+    args->runInstance.kernelId = va_arg(*al, char *);
+    args->runInstance.kernelURL = va_arg(*al, char *);
+    args->runInstance.ramdiskId = va_arg(*al, char *);
+    args->runInstance.ramdiskURL = va_arg(*al, char *);
+    args->runInstance.ownerId = va_arg(*al, char *);
+    args->runInstance.accountId = va_arg(*al, char *);
+    args->runInstance.keyName = va_arg(*al, char *);
+    args->runInstance.ncnet = va_arg(*al, netConfig *);
+    args->runInstance.userData = va_arg(*al, char *);
+    args->runInstance.credential = va_arg(*al, char *);
+    args->runInstance.launchIndex = va_arg(*al, char *);
+    args->runInstance.platform = va_arg(*al, char *);
+    args->runInstance.expiryTime = va_arg(*al, int);
+    args->runInstance.netNames = va_arg(*al, char **);
+    args->runInstance.netNamesLen = va_arg(*al, int);
+    args->runInstance.rootDirective = va_arg(*al, char *);
+    args->runInstance.outInst = va_arg(*al, ncInstance **);
+}
+
+static int nc_call_run_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    ncInstance **outInst = args->runInstance.outInst;
+    int rc = ncRunInstanceStub(ncs, meta, args->runInstance.uuid, args->runInstance.instanceId, args->runInstance.reservationId, args->runInstance.ncvm,
+                               args->runInstance.imageId, args->runInstance.imageURL, args->runInstance.kernelId, args->runInstance.kernelURL,
+                               args->runInstance.ramdiskId, args->runInstance.ramdiskURL, args->runInstance.ownerId, args->runInstance.accountId,
+                               args->runInstance.keyName, args->runInstance.ncnet, args->runInstance.userData, args->runInstance.credential,
+                               args->runInstance.launchIndex, args->runInstance.platform, args->runInstance.expiryTime, args->runInstance.netNames,
+                               args->runInstance.netNamesLen, args->runInstance.rootDirective, outInst);
+
+    if (outInst && (rc || !(*outInst))) {
+        EUCA_FREE(*outInst);
+        rc = 1;
+    }
+    return (rc);
+}
+
+static int nc_write_run_instance(int fd, ncOpArgs * args, int rc)
+{
+    int len = (rc ? 0 : 1);
+
+    if (args->runInstance.outInst == NULL)
+        return (rc);
+    if ((write(fd, &len, sizeof(int)) != sizeof(int)) || ((len > 0) && (write(fd, *(args->runInstance.outInst), sizeof(ncInstance)) != sizeof(ncInstance))))
+        return (1);
+    return (rc);
+}
+
+static int nc_read_run_instance(int fd, ncOpArgs * args, int timeout)
+{
+    int rc = EUCA_OK;
+    int len = 0;
+    ncInstance *inst = NULL;
+
+    if (args->runInstance.outInst == NULL)
+        return (EUCA_OK);
+    *(args->runInstance.outInst) = NULL;
+    if (!timeout)
+        return (EUCA_OK);
+
+    if (nc_reply_read(fd, &len, sizeof(int), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    if (len <= 0)
+        return (EUCA_ERROR);
+
+    if ((inst = EUCA_ZALLOC(1, sizeof(ncInstance))) == NULL) {
+        LOGFATAL("out of memory! ncOps=ncRunInstance\n");
+        unlock_exit(1);
+    }
+    rc = nc_reply_read(fd, inst, sizeof(ncInstance), timeout);
+    *(args->runInstance.outInst) = inst;
+    return (rc);
+}
+
+static void nc_unpack_describe_instances(ncOpArgs * args, va_list * al)
+{
+    args->describeInstances.instIds = va_arg(*al, char **);
+    args->describeInstances.instIdsLen = va_arg(*al, int);
+    args->describeInstances.outInsts = va_arg(*al, ncInstance ***);
+    args->describeInstances.outInstsLen = va_arg(*al, int *);
+}
+
+static int nc_call_describe_instances(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    ncInstance ***outInsts = args->describeInstances.outInsts;
+    int *outInstsLen = args->describeInstances.outInstsLen;
+    int rc = ncDescribeInstancesStub(ncs, meta, args->describeInstances.instIds, args->describeInstances.instIdsLen, outInsts, outInstsLen);
+
+    if (rc && outInsts && outInstsLen) {
+        nc_free_array((void ***)outInsts, outInstsLen);
+    }
+    return (rc);
+}
+
+static int nc_write_describe_instances(int fd, ncOpArgs * args, int rc)
+{
+    int i = 0;
+    int len = 0;
+
+    if (!args->describeInstances.outInsts || !args->describeInstances.outInstsLen)
+        return (rc);
+
+    len = (rc ? 0 : *(args->describeInstances.outInstsLen));
+    if (write(fd, &len, sizeof(int)) != sizeof(int))
+        return (1);
+    for (i = 0; i < len; i++) {
+        if (write(fd, (*(args->describeInstances.outInsts))[i], sizeof(ncInstance)) != sizeof(ncInstance))
+            return (1);
+    }
+    return (rc);
+}
+
+static int nc_read_describe_instances(int fd, ncOpArgs * args, int timeout)
+{
+    ncInstance ***outInsts = args->describeInstances.outInsts;
+    int *outInstsLen = args->describeInstances.outInstsLen;
+
+    if (!outInsts || !outInstsLen)
+        return (EUCA_OK);
+    *outInsts = NULL;
+    *outInstsLen = 0;
+    if (!timeout)
+        return (EUCA_OK);
+    return (nc_reply_read_array(fd, (void ***)outInsts, outInstsLen, &instance_slab, timeout));
+}
+
+static void nc_unpack_describe_instances_delta(ncOpArgs * args, va_list * al)
+{
+    args->describeInstancesDelta.sinceGeneration = va_arg(*al, long long);
+    args->describeInstancesDelta.outInsts = va_arg(*al, ncInstance ***);
+    args->describeInstancesDelta.outInstsLen = va_arg(*al, int *);
+    args->describeInstancesDelta.unchangedIds = va_arg(*al, char ***);
+    args->describeInstancesDelta.unchangedIdsLen = va_arg(*al, int *);
+    args->describeInstancesDelta.generation = va_arg(*al, long long *);
+}
+
+static int nc_call_describe_instances_delta(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    int rc = ncDescribeInstancesDeltaStub(ncs, meta, args->describeInstancesDelta.sinceGeneration, args->describeInstancesDelta.outInsts,
+                                          args->describeInstancesDelta.outInstsLen, args->describeInstancesDelta.unchangedIds,
+                                          args->describeInstancesDelta.unchangedIdsLen, args->describeInstancesDelta.generation);
+
+    if (rc) {
+        nc_free_array((void ***)args->describeInstancesDelta.outInsts, args->describeInstancesDelta.outInstsLen);
+        nc_free_array((void ***)args->describeInstancesDelta.unchangedIds, args->describeInstancesDelta.unchangedIdsLen);
+        *(args->describeInstancesDelta.generation) = 0;
+    }
+    return (rc);
+}
+
+static int nc_write_describe_instances_delta(int fd, ncOpArgs * args, int rc)
+{
+    int i = 0;
+    int len = 0;
+    char idBuf[SMALL_CHAR_BUFFER_SIZE] = "";
+
+    len = (rc ? 0 : *(args->describeInstancesDelta.outInstsLen));
+    if (write(fd, &len, sizeof(int)) != sizeof(int))
+        return (1);
+    for (i = 0; i < len; i++) {
+        if (write(fd, (*(args->describeInstancesDelta.outInsts))[i], sizeof(ncInstance)) != sizeof(ncInstance))
+            return (1);
+    }
+
+    len = (rc ? 0 : *(args->describeInstancesDelta.unchangedIdsLen));
+    if (write(fd, &len, sizeof(int)) != sizeof(int))
+        return (1);
+    for (i = 0; i < len; i++) {
+        euca_strncpy(idBuf, (*(args->describeInstancesDelta.unchangedIds))[i], sizeof(idBuf));
+        if (write(fd, idBuf, sizeof(idBuf)) != sizeof(idBuf))
+            return (1);
+    }
+
+    if (write(fd, args->describeInstancesDelta.generation, sizeof(long long)) != sizeof(long long))
+        return (1);
+    return (rc);
+}
+
+static int nc_read_describe_instances_delta(int fd, ncOpArgs * args, int timeout)
+{
+    int i = 0;
+    int len = 0;
+    char idBuf[SMALL_CHAR_BUFFER_SIZE] = "";
+    char ***unchangedIds = args->describeInstancesDelta.unchangedIds;
+    int *unchangedIdsLen = args->describeInstancesDelta.unchangedIdsLen;
+
+    *(args->describeInstancesDelta.outInsts) = NULL;
+    *(args->describeInstancesDelta.outInstsLen) = 0;
+    *unchangedIds = NULL;
+    *unchangedIdsLen = 0;
+    *(args->describeInstancesDelta.generation) = 0;
+    if (!timeout)
+        return (EUCA_OK);
+
+    if (nc_reply_read_array(fd, (void ***)args->describeInstancesDelta.outInsts, args->describeInstancesDelta.outInstsLen, &instance_slab, timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+
+    if (nc_reply_read(fd, &len, sizeof(int), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    if (len > 0) {
+        if ((*unchangedIds = EUCA_ZALLOC(len, sizeof(char *))) == NULL) {
+            LOGFATAL("out of memory! ncOps=ncDescribeInstancesDelta\n");
+            unlock_exit(1);
+        }
+        for (i = 0; i < len; i++) {
+            if (nc_reply_read(fd, idBuf, sizeof(idBuf), timeout) != EUCA_OK)
+                return (EUCA_IO_ERROR);
+            idBuf[sizeof(idBuf) - 1] = '\0';
+            (*unchangedIds)[i] = strdup(idBuf);
+            (*unchangedIdsLen)++;
+        }
+    }
+    return (nc_reply_read(fd, args->describeInstancesDelta.generation, sizeof(long long), timeout));
+}
+
+static void nc_unpack_describe_resource(ncOpArgs * args, va_list * al)
+{
+    args->describeResource.resourceType = va_arg(*al, char *);
+    args->describeResource.outRes = va_arg(*al, ncResource **);
+    args->describeResource.errMsg = va_arg(*al, char **);
+}
+
+static int nc_call_describe_resource(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    int len = 0;
+    char *errStr = NULL;
+    char **errMsg = args->describeResource.errMsg;
+    ncResource **outRes = args->describeResource.outRes;
+    int rc = ncDescribeResourceStub(ncs, meta, args->describeResource.resourceType, outRes);
+
+    if (outRes && (rc || !(*outRes))) {
+        EUCA_FREE(*outRes);
+        errStr = (char *)axutil_error_get_message(ncs->env->error);
+        if (errMsg && errStr && (len = strnlen(errStr, 1024 - 1))) {
+            *errMsg = strndup(errStr, len);
+        }
+        rc = 1;
+    }
+    return (rc);
+}
+
+static int nc_write_describe_resource(int fd, ncOpArgs * args, int rc)
+{
+    int failed = (rc ? 1 : 0);
+    int len = (rc ? 0 : sizeof(ncResource));
+
+    if (args->describeResource.outRes == NULL)
+        return (rc);
+
+    // the NC result goes first, then the resource or the error message
+    if (write(fd, &failed, sizeof(int)) != sizeof(int))
+        return (1);
+    if (!failed) {
+        if ((write(fd, &len, sizeof(int)) != sizeof(int)) || (write(fd, *(args->describeResource.outRes), len) != len))
+            return (1);
+    } else {
+        nc_reply_write_string(fd, ((args->describeResource.errMsg) ? *(args->describeResource.errMsg) : NULL));
+    }
+    return (rc);
+}
+
+static int nc_read_describe_resource(int fd, ncOpArgs * args, int timeout)
+{
+    int len = 0;
+    int failed = 0;
+    char *errStr = NULL;
+    ncResource **outRes = args->describeResource.outRes;
+
+    if (outRes == NULL)
+        return (EUCA_OK);
+    *outRes = NULL;
+    if (!timeout)
+        return (EUCA_OK);
+
+    if (nc_reply_read(fd, &failed, sizeof(int), timeout) != EUCA_OK)
+        return (EUCA_IO_ERROR);
+    if (failed) {
+        if (nc_reply_read_string(fd, &errStr, timeout) != EUCA_OK)
+            return (EUCA_IO_ERROR);
+        if (args->describeResource.errMsg && errStr) {
+            *(args->describeResource.errMsg) = errStr;
+        } else {
+            EUCA_FREE(errStr);
+        }
+        return (EUCA_ERROR);
+    }
+
+    if ((nc_reply_read(fd, &len, sizeof(int), timeout) != EUCA_OK) || (len != sizeof(ncResource)))
+        return (EUCA_IO_ERROR);
+    if ((*outRes = EUCA_ZALLOC(1, sizeof(ncResource))) == NULL) {
+        LOGFATAL("out of memory! ncOps=ncDescribeResource\n");
+        unlock_exit(1);
+    }
+    return (nc_reply_read(fd, *outRes, sizeof(ncResource), timeout));
+}
+
+static void nc_unpack_describe_sensors(ncOpArgs * args, va_list * al)
+{
+    args->describeSensors.historySize = va_arg(*al, int);
+    args->describeSensors.collectionIntervalTimeMs = va_arg(*al, long long);
+    args->describeSensors.instIds = va_arg(*al, char **);
+    args->describeSensors.instIdsLen = va_arg(*al, int);
+    args->describeSensors.sensorIds = va_arg(*al, char **);
+    args->describeSensors.sensorIdsLen = va_arg(*al, int);
+    args->describeSensors.srs = va_arg(*al, sensorResource ***);
+    args->describeSensors.srsLen = va_arg(*al, int *);
+}
+
+static int nc_call_describe_sensors(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    sensorResource ***srs = args->describeSensors.srs;
+    int *srsLen = args->describeSensors.srsLen;
+    int rc = ncDescribeSensorsStub(ncs, meta, args->describeSensors.historySize, args->describeSensors.collectionIntervalTimeMs, args->describeSensors.instIds,
+                                   args->describeSensors.instIdsLen, args->describeSensors.sensorIds, args->describeSensors.sensorIdsLen, srs, srsLen);
+
+    if (rc && srs && srsLen) {
+        nc_free_array((void ***)srs, srsLen);
+    }
+    return (rc);
+}
+
+static void nc_unpack_describe_sensors_batched(ncOpArgs * args, va_list * al)
+{
+    args->describeSensors.historySize = va_arg(*al, int);
+    args->describeSensors.collectionIntervalTimeMs = va_arg(*al, long long);
+    args->describeSensors.cursors = va_arg(*al, char *);
+    args->describeSensors.srs = va_arg(*al, sensorResource ***);
+    args->describeSensors.srsLen = va_arg(*al, int *);
+}
+
+static int nc_call_describe_sensors_batched(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    sensorResource ***srs = args->describeSensors.srs;
+    int *srsLen = args->describeSensors.srsLen;
+    int rc = ncDescribeSensorsBatchedStub(ncs, meta, args->describeSensors.historySize, args->describeSensors.collectionIntervalTimeMs,
+                                          args->describeSensors.cursors, srs, srsLen);
+
+    if (rc && srs && srsLen) {
+        nc_free_array((void ***)srs, srsLen);
+    }
+    return (rc);
+}
+
+static int nc_write_describe_sensors(int fd, ncOpArgs * args, int rc)
+{
+    int i = 0;
+    int len = 0;
+
+    if (!args->describeSensors.srs || !args->describeSensors.srsLen)
+        return (rc);
+
+    len = (rc ? 0 : *(args->describeSensors.srsLen));
+    if (write(fd, &len, sizeof(int)) != sizeof(int))
+        return (1);
+    for (i = 0; i < len; i++) {
+        if (write(fd, (*(args->describeSensors.srs))[i], sizeof(sensorResource)) != sizeof(sensorResource))
+            return (1);
+    }
+    return (rc);
+}
+
+static int nc_read_describe_sensors(int fd, ncOpArgs * args, int timeout)
+{
+    sensorResource ***srs = args->describeSensors.srs;
+    int *srsLen = args->describeSensors.srsLen;
+
+    if (!srs || !srsLen)
+        return (EUCA_OK);
+    *srs = NULL;
+    *srsLen = 0;
+    if (!timeout)
+        return (EUCA_OK);
+    return (nc_reply_read_array(fd, (void ***)srs, srsLen, &sensor_resource_slab, timeout));
+}
+
+static void nc_unpack_bundle_instance(ncOpArgs * args, va_list * al)
+{
+    args->bundleInstance.instanceId = va_arg(*al, char *);
+    args->bundleInstance.bucketName = va_arg(*al, char *);
+    args->bundleInstance.filePrefix = va_arg(*al, char *);
+    args->bundleInstance.objectStorageURL = va_arg(*al, char *);
+    args->bundleInstance.userPublicKey = va_arg(*al, char *);
+    args->bundleInstance.S3Policy = va_arg(*al, char *);
+    args->bundleInstance.S3PolicySig = va_arg(*al, char *);
+    args->bundleInstance.architecture = va_arg(*al, char *);
+}
+
+static int nc_call_bundle_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncBundleInstanceStub(ncs, meta, args->bundleInstance.instanceId, args->bundleInstance.bucketName, args->bundleInstance.filePrefix,
+                                 args->bundleInstance.objectStorageURL, args->bundleInstance.userPublicKey, args->bundleInstance.S3Policy,
+                                 args->bundleInstance.S3PolicySig, args->bundleInstance.architecture));
+}
+
+static int nc_call_bundle_restart_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncBundleRestartInstanceStub(ncs, meta, args->string));
+}
+
+static int nc_call_cancel_bundle_task(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncCancelBundleTaskStub(ncs, meta, args->string));
+}
+
+static int nc_call_modify_node(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncModifyNodeStub(ncs, meta, args->string));
+}
+
+static void nc_unpack_migrate_instances(ncOpArgs * args, va_list * al)
+{
+    args->migrateInstances.instances = va_arg(*al, ncInstance **);
+    args->migrateInstances.instancesLen = va_arg(*al, int);
+    args->migrateInstances.action = va_arg(*al, char *);
+    args->migrateInstances.credentials = va_arg(*al, char *);
+}
+
+static int nc_call_migrate_instances(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncMigrateInstancesStub(ncs, meta, args->migrateInstances.instances, args->migrateInstances.instancesLen, args->migrateInstances.action,
+                                   args->migrateInstances.credentials));
+}
+
+static int nc_call_start_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncStartInstanceStub(ncs, meta, args->string));
+}
+
+static int nc_call_stop_instance(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    return (ncStopInstanceStub(ncs, meta, args->string));
+}
+
+static void nc_unpack_instance_list(ncOpArgs * args, va_list * al)
+{
+    args->instanceList.instIds = va_arg(*al, char **);
+    args->instanceList.instIdsLen = va_arg(*al, int);
+}
+
+static void nc_unpack_terminate_instances(ncOpArgs * args, va_list * al)
+{
+    nc_unpack_instance_list(args, al);
+    args->instanceList.force = va_arg(*al, int);
+}
+
+//! Terminates the instances in one call or, on an NC that predates ncTerminateInstances, one by
+//! one, releasing their addresses as ncTerminateInstances does
+static int nc_call_terminate_instances(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    int rc = 0;
+    int shutdownState = 0;
+    int previousState = 0;
+    char *corrid = ((meta->correlationId) ? strdup(meta->correlationId) : NULL);   // the stubs consume it
+
+    if ((rc = ncTerminateInstancesStub(ncs, meta, args->instanceList.instIds, args->instanceList.instIdsLen, args->instanceList.force, NULL)) == -1) {
+        LOGDEBUG("terminating %d instances one at a time\n", args->instanceList.instIdsLen);
+        for (int i = 0; i < args->instanceList.instIdsLen; i++) {
+            meta->correlationId = ((corrid) ? strdup(corrid) : NULL);
+            if ((rc = ncTerminateInstanceStub(ncs, meta, args->instanceList.instIds[i], args->instanceList.force, &shutdownState, &previousState)) == -1)
+                break;                 // the NC is not answering
+            meta->correlationId = ((corrid) ? strdup(corrid) : NULL);
+            ncAssignAddressStub(ncs, meta, args->instanceList.instIds[i], "0.0.0.0");
+        }
+    }
+    EUCA_FREE(corrid);
+    return (rc);
+}
+
+//! Reboots the instances in one call or, on an NC that predates ncRebootInstances, one by one
+static int nc_call_reboot_instances(ncStub * ncs, ncMetadata * meta, ncOpArgs * args)
+{
+    int rc = 0;
+    char *corrid = ((meta->correlationId) ? strdup(meta->correlationId) : NULL);   // the stubs consume it
+
+    if ((rc = ncRebootInstancesStub(ncs, meta, args->instanceList.instIds, args->instanceList.instIdsLen, NULL)) == -1) {
+        LOGDEBUG("rebooting %d instances one at a time\n", args->instanceList.instIdsLen);
+        for (int i = 0; i < args->instanceList.instIdsLen; i++) {
+            meta->correlationId = ((corrid) ? strdup(corrid) : NULL);
+            if ((rc = ncRebootInstanceStub(ncs, meta, args->instanceList.instIds[i])) == -1)
+                break;                 // the NC is not answering
+        }
+    }
+    EUCA_FREE(corrid);
+    return (rc);
+}
+
+//! @}
+
+//! The NC operations, indexed by ncOpId
+static const ncOperation ncOperations[NC_OPS] = {
+    {"ncGetConsoleOutput", FALSE, nc_unpack_get_console_output, nc_call_get_console_output, nc_write_get_console_output, nc_read_get_console_output},
+    {"ncAttachVolume", FALSE, nc_unpack_attach_volume, nc_call_attach_volume, NULL, NULL},
+    {"ncDetachVolume", FALSE, nc_unpack_detach_volume, nc_call_detach_volume, NULL, NULL},
+    {"ncCreateImage", FALSE, nc_unpack_create_image, nc_call_create_image, NULL, NULL},
+    {"ncPowerDown", FALSE, nc_unpack_none, nc_call_power_down, NULL, NULL},
+    {"ncAssignAddress", FALSE, nc_unpack_assign_address, nc_call_assign_address, NULL, NULL},
+    {"ncBroadcastNetworkInfo", FALSE, nc_unpack_string, nc_call_broadcast_network_info, NULL, NULL},
+    {"ncRebootInstance", FALSE, nc_unpack_string, nc_call_reboot_instance, NULL, NULL},
+    {"ncTerminateInstance", FALSE, nc_unpack_terminate_instance, nc_call_terminate_instance, nc_write_terminate_instance, nc_read_terminate_instance},
+    {"ncStartNetwork", FALSE, nc_unpack_start_network, nc_call_start_network, nc_write_start_network, nc_read_start_network},
+    {"ncRunInstance", FALSE, nc_unpack_run_instance, nc_call_run_instance, nc_write_run_instance, nc_read_run_instance},
+    {"ncDescribeInstances", FALSE, nc_unpack_describe_instances, nc_call_describe_instances, nc_write_describe_instances, nc_read_describe_instances},
+    {"ncDescribeInstancesDelta", FALSE, nc_unpack_describe_instances_delta, nc_call_describe_instances_delta, nc_write_describe_instances_delta,
+     nc_read_describe_instances_delta},
+    {"ncDescribeResource", FALSE, nc_unpack_describe_resource, nc_call_describe_resource, nc_write_describe_resource, nc_read_describe_resource},
+    {"ncDescribeSensors", FALSE, nc_unpack_describe_sensors, nc_call_describe_sensors, nc_write_describe_sensors, nc_read_describe_sensors},
+    {"ncDescribeSensorsBatched", FALSE, nc_unpack_describe_sensors_batched, nc_call_describe_sensors_batched, nc_write_describe_sensors,
+     nc_read_describe_sensors},
+    {"ncBundleInstance", FALSE, nc_unpack_bundle_instance, nc_call_bundle_instance, NULL, NULL},
+    {"ncBundleRestartInstance", FALSE, nc_unpack_string, nc_call_bundle_restart_instance, NULL, NULL},
+    {"ncCancelBundleTask", FALSE, nc_unpack_string, nc_call_cancel_bundle_task, NULL, NULL},
+    {"ncModifyNode", FALSE, nc_unpack_string, nc_call_modify_node, NULL, NULL},
+    {"ncMigrateInstances", TRUE, nc_unpack_migrate_instances, nc_call_migrate_instances, NULL, NULL},
+    {"ncStartInstance", TRUE, nc_unpack_string, nc_call_start_instance, NULL, NULL},
+    {"ncStopInstance", TRUE, nc_unpack_string, nc_call_stop_instance, NULL, NULL},
+    {"ncTerminateInstances", FALSE, nc_unpack_terminate_instances, nc_call_terminate_instances, NULL, NULL},
+    {"ncRebootInstances", FALSE, nc_unpack_instance_list, nc_call_reboot_instances, NULL, NULL},
+};
+
+//!
+//! Makes the metadata sent along with an NC call, a copy of that of the request
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] op the NC operation
+//!
+//! @return the metadata, to be freed with ncClientCallMetaFree()
+//!
+static ncMetadata *ncClientCallMeta(ncMetadata * pMeta, const ncOperation * op)
+{
+    ncMetadata *localmeta = NULL;
+
+    localmeta = EUCA_ZALLOC(1, sizeof(ncMetadata));
+    if (!localmeta) {
+        LOGFATAL("out of memory! ncOps=%s\n", op->name);
+        unlock_exit(1);
+    }
+    memcpy(localmeta, pMeta, sizeof(ncMetadata));
+    localmeta->replyString = NULL;
+    localmeta->correlationId = strdup((pMeta->correlationId) ? pMeta->correlationId : "unset");
+    localmeta->userId = strdup((pMeta->userId) ? pMeta->userId : "eucalyptus");
+
+    //TODO: zhill, change this to only be invoked on DescribeInstances and/or DescribeResources?
+    //Update meta from config
+    if (populateOutboundMeta(localmeta)) {
+        LOGERROR("Failed to update output service metadata\n");
+    }
+    //Don't need to filter, CC should only have received.
+    //filter_services(localmeta, config->ccStatus.serviceId.partition);
+    return (localmeta);
+}
+
+//!
+//! Frees the metadata made by ncClientCallMeta(), logging the reply of the NC if any
+//!
+//! @param[in] localmeta the metadata
+//! @param[in] op the NC operation
+//!
+static void ncClientCallMetaFree(ncMetadata * localmeta, const ncOperation * op)
+{
+    if (localmeta->replyString != NULL) {
+        LOGDEBUG("NC replied to '%s' with '%s'\n", op->name, localmeta->replyString);
+    }
+
+    EUCA_FREE(localmeta->replyString);
+    EUCA_FREE(localmeta->correlationId);
+    EUCA_FREE(localmeta->userId);
+    EUCA_FREE(localmeta);
+}
+
+//!
+//! Performs an NC operation in-process through a pooled stub. The arguments and the
+//! outputs are the same as for ncClientCall() and outputs are only set when the call
+//! succeeds, exactly as the fork()ing path does.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] ncs a pointer to the pooled NC stub to use
+//! @param[in] op the NC operation
+//! @param[in] args the operation specific arguments
+//!
+//! @return 0 on success or 1 on failure
+//!
+//! @pre The caller must hold the per-NC lock and have armed the stub timeout.
+//!
+static int ncClientCallPooled(ncMetadata * pMeta, ncStub * ncs, const ncOperation * op, ncOpArgs * args)
+{
+    int rc = 0;
+    ncMetadata *localmeta = ncClientCallMeta(pMeta, op);
+
+    LOGTRACE("\tncOps=%s pid=%d pooled client calling '%s'\n", op->name, getpid(), op->name);
+    rc = op->call(ncs, localmeta, args);
+    if (op->replies) {
+        pMeta->replyString = localmeta->replyString;
+        localmeta->replyString = NULL;
+    }
+    LOGTRACE("\tncOps=%s pid=%d done calling '%s' with exit code '%d'\n", op->name, getpid(), op->name, rc);
+
+    ncClientCallMetaFree(localmeta, op);
+    return ((rc) ? 1 : 0);
+}
+
+//!
+//! Performs an NC operation, through a pooled stub or in a forked child that sends the outputs
+//! back over a pipe. The variable arguments are those of the stub of the operation (see
+//! client-marshal.h), less the stub and the metadata, and are unpacked once into an ncOpArgs by
+//! the entry of the operation in ncOperations[].
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout in seconds, or 0 to not wait for the outputs (fire and forget)
+//! @param[in] ncLock
+//! @param[in] ncURL
+//! @param[in] ncOp the NC operation
+//! @param[in] ...
+//!
+//! @return 0 on success or 1 on failure
+//!
+//! @note When the NC connection pool is enabled, calls with a timeout are made in-process
+//!       through a long-lived stub, see ncClientCallPooled(). Calls without a timeout
+//!       (fire and forget) and calls for which no pooled stub is available still fork.
+//!
+//! @note Calls to an NC wait for each other on ncLock, unless it is NCCALL_UNLOCKED.
+//!
+int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, ncOpId ncOp, ...)
+{
+    int pid = 0;
+    int rc = 0;
+    int ret = 0;
+    int status = 0;
+    int opFail = 0;
+    int slot = -1;
+    int filedes[2] = { 0 };
+    int span = -1;
+    va_list al = { {0} };
+    ncOpArgs args = { NULL };
+    const ncOperation *op = NULL;
+
+    if ((ncOp < 0) || (ncOp >= NC_OPS)) {
+        LOGERROR("invalid NC operation %d ncURL=%s\n", ncOp, ncURL);
+        return (1);
+    }
+    op = &ncOperations[ncOp];
+
+    va_start(al, ncOp);
+    op->unpack(&args, &al);
+    va_end(al);
+
+    LOGTRACE("invoked: ncOps=%s ncURL=%s timeout=%d\n", op->name, ncURL, timeout); // these are common
+
+    // the stub sends the correlation ID of this span, in the forked child too
+    span = trace_begin_client(op->name, ((pMeta != NULL) ? pMeta->correlationId : NULL));
+    EUCA_PROBE2(nc__call__start, op->name, ncURL);
+
+    if (config->use_ncpool && timeout) {
+        if ((slot = ncStubPoolAcquire(ncURL, timeout)) >= 0) {
+            if (ncLock != NCCALL_UNLOCKED)
+                sem_mywait(ncLock);
+            ret = ncClientCallPooled(pMeta, ncStubPool[slot].stub, op, &args);
+            if (ncLock != NCCALL_UNLOCKED)
+                sem_mypost(ncLock);
+
+            ncStubPoolRelease(slot, ret);
+            LOGTRACE("done ncOps=%s pooled clientrc=%d\n", op->name, ret);
+            EUCA_PROBE3(nc__call__done, op->name, ncURL, ret);
+            trace_end(span, ret);
+            return (ret);
+        }
+        LOGDEBUG("no pooled NC stub available for ncURL=%s, forking for ncOps=%s\n", ncURL, op->name);
+    }
+
+    if ((rc = pipe(filedes)) != 0) {
+        LOGERROR("cannot create pipe ncOps=%s\n", op->name);
+        EUCA_PROBE3(nc__call__done, op->name, ncURL, 1);
+        trace_end(span, TRUE);
+        return (1);
+    }
+
+    // grab the lock
+    if (ncLock != NCCALL_UNLOCKED)
+        sem_mywait(ncLock);
+
+    if ((pid = fork()) == 0) {
+        ncStub *ncs = NULL;
+        ncMetadata *localmeta = NULL;
+
+        // the caller holds ncLock, so this child must not release it through a SIGTERM handler inherited from the caller
+        signal(SIGTERM, SIG_DFL);
+
+        LOGTRACE("forked to service NC invocation: %s\n", op->name);
+        localmeta = ncClientCallMeta(pMeta, op);
+
+        close(filedes[0]);
+        ncs = ncStubCreate(ncURL, NULL, NULL);
+        if (config->use_wssec) {
+            rc = InitWSSEC(ncs->env, ncs->stub, config->policyFile);
+        }
+
+        LOGTRACE("\tncOps=%s ppid=%d client calling '%s'\n", op->name, getppid(), op->name);
+        rc = op->call(ncs, localmeta, &args);
+        if (timeout && op->write) {
+            rc = op->write(filedes[1], &args, rc);
+        }
+        if (timeout && op->replies) {
+            nc_reply_write_string(filedes[1], localmeta->replyString);
+        }
+        LOGTRACE("\tncOps=%s ppid=%d done calling '%s' with exit code '%d'\n", op->name, getppid(), op->name, rc);
+        close(filedes[1]);
+
+        // Free our local meta data structure and associated memory
+        ncClientCallMetaFree(localmeta, op);
+
+        // ditch our stub
+        if (ncs != NULL) {
+            ncStubDestroy(ncs);
+            ncs = NULL;
+        }
+        exit((rc) ? 1 : 0);
+    } else if (pid < 0) {
+        LOGERROR("cannot fork ncOps=%s\n", op->name);
+        close(filedes[0]);
+        close(filedes[1]);
+        rc = 1;
+    } else {
+        // returns for each client call
+        close(filedes[1]);
+
+        // the outputs are cleared even if they are not waited for
+        rc = ((op->read) ? op->read(filedes[0], &args, timeout) : EUCA_OK);
+        if ((rc == EUCA_OK) && timeout && op->replies) {
+            rc = nc_reply_read_string(filedes[0], &(pMeta->replyString), timeout);
+        }
+        if (rc == EUCA_IO_ERROR) {
+            killwait(pid);
+        }
+        opFail = ((rc == EUCA_OK) ? 0 : 1);
+
+        close(filedes[0]);
+        if (timeout) {
+            rc = timewait(pid, &status, timeout);
+            if (WIFEXITED(status)) {
+                rc = WEXITSTATUS(status);
+            } else {
+                int sig = -1;
+                int dump = 0;
+                if (WIFSIGNALED(status)) {
+                    sig = WTERMSIG(status);
+                    dump = WCOREDUMP(status);
+                }
+                if (sig == SIGTERM || sig == SIGKILL) { // our killwait() first tries SIGTERM and then SIGKILL
+                    LOGDEBUG("child process %d handling '%s' was terminated with %d\n", pid, op->name, sig);
+                } else {
+                    LOGERROR("BUG: child process %d handling '%s' was terminated with %d (core=%d)\n", pid, op->name, sig, dump);
+                }
+                rc = 1;
+            }
+        } else {
+            rc = 0;
+        }
+    }
+
+    LOGTRACE("done ncOps=%s clientrc=%d opFail=%d\n", op->name, rc, opFail);
+    if (rc || opFail) {
+        ret = 1;
+    } else {
+        ret = 0;
+    }
+
+    // release the lock
+    if (ncLock != NCCALL_UNLOCKED)
+        sem_mypost(ncLock);
+
+    EUCA_PROBE3(nc__call__done, op->name, ncURL, ret);
+    trace_end(span, ret);
+    return (ret);
+}
+
+//!
+//! Calculate nc call timeout, based on when operation was started (op_start), the total
+//! number of calls to make (numCalls), and the current progress (idx)
+//!
+//! @param[in] op_start when the operation started, from mono_time_sec()
+//! @param[in] op_max
+//! @param[in] numCalls
+//! @param[in] idx
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx)
+{
+    time_t op_timer, op_pernode;
+    int numLeft;
+
+    numLeft = numCalls - idx;
+    if (numLeft <= 0) {
+        numLeft = 1;
+    }
+
+    op_timer = op_max - (mono_time_sec() - op_start);
+    op_pernode = op_timer / numLeft;
+
+    return (maxint(minint(op_pernode, OP_TIMEOUT_PERNODE), OP_TIMEOUT_MIN));
 }
 
 //!
@@ -1436,11 +2182,11 @@ int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
     ccInstance *myInstance;
     time_t op_start;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     i = 0;
     myInstance = NULL;
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -1455,10 +2201,6 @@ int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
         // found the instance in the cache
@@ -1469,16 +2211,21 @@ int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (i = start; i < stop && !done; i++) {
+        if (get_resourceCacheEntry(i, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, stop - start, i);
         timeout = maxint(timeout, ATTACH_VOL_TIMEOUT_SECONDS);
 
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[i].lockidx, resourceCacheLocal.resources[i].ncURL, "ncAttachVolume",
-                          instanceId, volumeId, remoteDev, localDev);
+        // attaching can take a while, it must not hold up the polls of the node nor the other attachments to it,
+        // which the NC runs concurrently
+        rc = ncClientCall(pMeta, timeout, NCCALL_UNLOCKED, resourceLocal.ncURL, NC_OP_ATTACH_VOLUME, instanceId, volumeId, remoteDev, localDev);
 
         if (rc) {
             ret = 1;
@@ -1516,11 +2263,11 @@ int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
     ccInstance *myInstance;
     time_t op_start;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     i = 0;
     myInstance = NULL;
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -1532,11 +2279,7 @@ int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
     if (!volumeId || !instanceId || !remoteDev || !localDev) {
         LOGERROR("bad input params\n");
         return (1);
-    }
-
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    }
 
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
@@ -1548,15 +2291,19 @@ int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *r
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     for (i = start; i < stop; i++) {
+        if (get_resourceCacheEntry(i, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, stop - start, i);
         timeout = maxint(timeout, DETACH_VOL_TIMEOUT_SECONDS);
 
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[i].lockidx, resourceCacheLocal.resources[i].ncURL, "ncDetachVolume",
-                          instanceId, volumeId, remoteDev, localDev, force);
+        // like attachments, detachments run alongside the other calls to the node
+        rc = ncClientCall(pMeta, timeout, NCCALL_UNLOCKED, resourceLocal.ncURL, NC_OP_DETACH_VOLUME, instanceId, volumeId, remoteDev, localDev, force);
         if (rc) {
             ret = 1;
         } else {
@@ -1821,7 +2568,7 @@ int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst)
 {
     int rc, ret;
     ccInstance *myInstance = NULL;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -1837,10 +2584,6 @@ int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst)
     }
     set_dirty_instanceCache();
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
     ret = 1;
     if (!strcmp(vnetconfig->mode, NETMODE_SYSTEM) || !strcmp(vnetconfig->mode, NETMODE_STATIC)) {
         ret = 0;
@@ -1882,8 +2625,10 @@ int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst)
                 // found the instance in the cache
                 if (myInstance) {
                     //timeout = ncGetTimeout(op_start, OP_TIMEOUT, 1, myInstance->ncHostIdx);
-                    rc = ncClientCall(pMeta, OP_TIMEOUT, resourceCacheLocal.resources[myInstance->ncHostIdx].lockidx,
-                                      resourceCacheLocal.resources[myInstance->ncHostIdx].ncURL, "ncAssignAddress", myInstance->instanceId, myInstance->ccnet.publicIp);
+                    if ((rc = get_resourceCacheEntry(myInstance->ncHostIdx, &resourceLocal)) == EUCA_OK) {
+                        rc = ncClientCall(pMeta, OP_TIMEOUT, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_ASSIGN_ADDRESS, myInstance->instanceId,
+                                          myInstance->ccnet.publicIp);
+                    }
                     if (rc) {
                         LOGERROR("could not sync public IP %s with NC\n", src);
                         ret = 1;
@@ -1904,39 +2649,79 @@ int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst)
 }
 
 //!
-//!
+//! Lists the public addresses of our pool
 //!
 //! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
-//! @param[out] outAddresses
-//! @param[out] outAddressesLen
-//!
-//! @return
+//! @param[out] outAddresses a copy of the pool entries holding an address, to be freed by the caller
+//! @param[out] outAddressesLen the number of entries in \p outAddresses
 //!
-//! @pre
+//! @return 0 on success or 1 on failure
 //!
-//! @note
+//! @see doDescribePublicAddressesDelta()
 //!
 int doDescribePublicAddresses(ncMetadata * pMeta, publicip ** outAddresses, int *outAddressesLen)
+{
+    int i = 0;
+    int ret = 0;
+    u32 seq = 0;
+    publicipDelta *deltas = NULL;
+
+    *outAddresses = NULL;
+    *outAddressesLen = 0;
+
+    if ((ret = doDescribePublicAddressesDelta(pMeta, 0, &deltas, outAddressesLen, &seq)) != 0)
+        return (ret);
+
+    if (*outAddressesLen > 0) {
+        if ((*outAddresses = EUCA_ZALLOC(*outAddressesLen, sizeof(publicip))) == NULL) {
+            LOGERROR("out of memory\n");
+            *outAddressesLen = 0;
+            ret = 1;
+        } else {
+            for (i = 0; i < *outAddressesLen; i++) {
+                (*outAddresses)[i] = deltas[i].addr;
+            }
+        }
+    }
+    EUCA_FREE(deltas);
+    return (ret);
+}
+
+//!
+//! Lists the public address pool slots that changed since a previous call, so callers keeping
+//! a copy of the pool do not have to fetch all of it on every poll.
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  since the \p outSeq returned by a previous call or 0 for the whole pool
+//! @param[out] outDeltas the changed slots, to be freed by the caller
+//! @param[out] outDeltasLen the number of entries in \p outDeltas
+//! @param[out] outSeq the value to pass as \p since on the next call
+//!
+//! @return 0 on success or 1 on failure
+//!
+//! @see vnetDescribePublicIPs()
+//!
+int doDescribePublicAddressesDelta(ncMetadata * pMeta, u32 since, publicipDelta ** outDeltas, int *outDeltasLen, u32 * outSeq)
 {
     int rc, ret;
 
+    *outDeltas = NULL;
+    *outDeltasLen = 0;
+    *outSeq = since;
+
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
         return (1);
     }
 
-    LOGDEBUG("invoked: userId=%s\n", SP(pMeta ? pMeta->userId : "UNSET"));
+    LOGDEBUG("invoked: userId=%s since=%u\n", SP(pMeta ? pMeta->userId : "UNSET"), since);
 
     ret = 0;
     if (!strcmp(vnetconfig->mode, NETMODE_MANAGED) || !strcmp(vnetconfig->mode, NETMODE_MANAGED_NOVLAN)) {
         sem_mywait(VNET);
-        *outAddresses = vnetconfig->publicips;
-        *outAddressesLen = NUMBER_OF_PUBLIC_IPS;
+        if (vnetDescribePublicIPs(vnetconfig, since, outDeltas, outDeltasLen, outSeq) != EUCA_OK)
+            ret = 1;
         sem_mypost(VNET);
-    } else {
-        *outAddresses = NULL;
-        *outAddressesLen = 0;
-        ret = 0;
     }
 
     LOGTRACE("done\n");
@@ -1964,7 +2749,7 @@ int doUnassignAddress(ncMetadata * pMeta, char *src, char *dst)
     int rc = 0;
     int ret = 0;
     ccInstance *myInstance = NULL;
-    ccResourceCache resourceCacheLocal = { {{{0}}} };
+    ccResource resourceLocal = { {0} };
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -1980,10 +2765,6 @@ int doUnassignAddress(ncMetadata * pMeta, char *src, char *dst)
     }
     set_dirty_instanceCache();
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
     ret = 0;
 
     if ((rc = find_instanceCacheIP(src, &myInstance)) == 0) {
@@ -2006,8 +2787,9 @@ int doUnassignAddress(ncMetadata * pMeta, char *src, char *dst)
 
             if (!ret) {
                 //timeout = ncGetTimeout(op_start, OP_TIMEOUT, 1, myInstance->ncHostIdx);
-                rc = ncClientCall(pMeta, OP_TIMEOUT, resourceCacheLocal.resources[myInstance->ncHostIdx].lockidx,
-                                  resourceCacheLocal.resources[myInstance->ncHostIdx].ncURL, "ncAssignAddress", myInstance->instanceId, "0.0.0.0");
+                if ((rc = get_resourceCacheEntry(myInstance->ncHostIdx, &resourceLocal)) == EUCA_OK) {
+                    rc = ncClientCall(pMeta, OP_TIMEOUT, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_ASSIGN_ADDRESS, myInstance->instanceId, "0.0.0.0");
+                }
                 if (rc) {
                     LOGERROR("could not sync IP with NC\n");
                     ret = 1;
@@ -2220,203 +3002,732 @@ int doStartNetwork(ncMetadata * pMeta, char *accountId, char *uuid, char *netNam
                 }
             }
 
-            rc = vnetSetCCS(vnetconfig, ccs, ccsLen);
-            rc = vnetSetupTunnels(vnetconfig);
+            rc = vnetSetCCS(vnetconfig, ccs, ccsLen);
+            rc = vnetSetupTunnels(vnetconfig);
+
+            brname = NULL;
+            rc = vnetStartNetwork(vnetconfig, vlan, uuid, accountId, netName, &brname);
+            EUCA_FREE(brname);
+        }
+        sem_mypost(VNET);
+
+        if (rc) {
+            LOGERROR("vnetStartNetwork() failed (%d)\n", rc);
+            ret = 1;
+        } else {
+            ret = 0;
+        }
+
+    }
+
+    LOGTRACE("done\n");
+
+    shawn();
+
+    return (ret);
+}
+
+//!
+//!
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  ccvms
+//! @param[in]  vmLen
+//! @param[out] outTypesMax
+//! @param[out] outTypesAvail
+//! @param[out] outTypesLen
+//! @param[out] outNodes
+//! @param[out] outNodesLen
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int doDescribeResources(ncMetadata * pMeta, virtualMachine ** ccvms, int vmLen, int **outTypesMax, int **outTypesAvail, int *outTypesLen, ccResource ** outNodes, int *outNodesLen)
+{
+    int i;
+    int rc;
+    int j;
+    boolean same;
+    ccResource *res;
+    ccResourceType type = { 0 };
+    LOGDEBUG("invoked: userId=%s, vmLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), vmLen);
+
+    rc = initialize(pMeta, FALSE);
+    if (rc || ccIsEnabled()) {
+        return (1);
+    }
+
+    if (outTypesMax == NULL || outTypesAvail == NULL || outTypesLen == NULL || outNodes == NULL || outNodesLen == NULL) {
+        // input error
+        return (1);
+    }
+
+    *outTypesMax = NULL;
+    *outTypesAvail = NULL;
+
+    *outTypesMax = EUCA_ZALLOC(vmLen, sizeof(int));
+    *outTypesAvail = EUCA_ZALLOC(vmLen, sizeof(int));
+    if (*outTypesMax == NULL || *outTypesAvail == NULL) {
+        LOGERROR("out of memory\n");
+        unlock_exit(1);
+    }
+
+    *outTypesLen = vmLen;
+
+    for (i = 0; i < vmLen; i++) {
+        if ((*ccvms)[i].mem <= 0 || (*ccvms)[i].cores <= 0 || (*ccvms)[i].disk <= 0) {
+            LOGERROR("input error\n");
+            EUCA_FREE(*outTypesAvail);
+            EUCA_FREE(*outTypesMax);
+            *outTypesLen = 0;
+            return (1);
+        }
+    }
+
+    sem_mywait(RESCACHE);
+    {
+        *outNodes = EUCA_ZALLOC(resourceCache->numResources, sizeof(ccResource));
+        if (*outNodes == NULL) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
+        } else {
+            memcpy(*outNodes, resourceCache->resources, sizeof(ccResource) * resourceCache->numResources);
+            *outNodesLen = resourceCache->numResources;
+        }
+
+        if (vmLen <= RESCACHE_MAX_VM_TYPES) {
+            // the types rarely change between requests, so the counts kept up to date by
+            // count_resourceCacheNode() are read as they are
+            same = (vmLen == resourceCache->numTypes);
+            for (j = 0; same && (j < vmLen); j++) {
+                same = (((*ccvms)[j].mem == resourceCache->types[j].mem) && ((*ccvms)[j].disk == resourceCache->types[j].disk)
+                        && ((*ccvms)[j].cores == resourceCache->types[j].cores));
+            }
+
+            if (!same) {
+                LOGDEBUG("VM types changed, counting their availability again\n");
+                bzero(resourceCache->types, sizeof(resourceCache->types));
+                for (j = 0; j < vmLen; j++) {
+                    resourceCache->types[j].mem = (*ccvms)[j].mem;
+                    resourceCache->types[j].disk = (*ccvms)[j].disk;
+                    resourceCache->types[j].cores = (*ccvms)[j].cores;
+                }
+                resourceCache->numTypes = vmLen;
+                resourceCache->typesValid = FALSE;
+            }
+
+            if (!resourceCache->typesValid)
+                recount_resourceCacheTypes();
+
+            for (j = 0; j < vmLen; j++) {
+                (*outTypesAvail)[j] = resourceCache->types[j].avail;
+                (*outTypesMax)[j] = resourceCache->types[j].max;
+            }
+        } else {
+            // too many types to keep counted, go through the nodes
+            for (j = 0; j < vmLen; j++) {
+                type.mem = (*ccvms)[j].mem;
+                type.disk = (*ccvms)[j].disk;
+                type.cores = (*ccvms)[j].cores;
+                for (i = 0; i < resourceCache->numResources; i++) {
+                    res = &(resourceCache->resources[i]);
+                    if (res->ncState != STOPPED) {
+                        (*outTypesAvail)[j] += resourceTypeFit(&type, res->availMemory, res->availDisk, res->availCores);
+                        (*outTypesMax)[j] += resourceTypeFit(&type, res->maxMemory, res->maxDisk, res->maxCores);
+                    }
+                }
+            }
+        }
+    }
+    sem_mypost(RESCACHE);
+
+    if (vmLen >= 5) {
+        LOGDEBUG("resources summary ({avail/max}): %s{%d/%d} %s{%d/%d} %s{%d/%d} %s{%d/%d} %s{%d/%d}\n", (*ccvms)[0].name,
+                 (*outTypesAvail)[0], (*outTypesMax)[0], (*ccvms)[1].name, (*outTypesAvail)[1], (*outTypesMax)[1], (*ccvms)[2].name,
+                 (*outTypesAvail)[2], (*outTypesMax)[2], (*ccvms)[3].name, (*outTypesAvail)[3], (*outTypesMax)[3], (*ccvms)[4].name, (*outTypesAvail)[4], (*outTypesMax)[4]);
+    }
+
+    LOGTRACE("done\n");
+
+    shawn();
+
+    return (0);
+}
+
+//!
+//!
+//!
+//! @param[in] in
+//! @param[in] newstate
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int changeState(ccResource * in, int newstate)
+{
+    if (in == NULL)
+        return (1);
+    if (in->state == newstate)
+        return (0);
+
+    in->lastState = in->state;
+    in->state = newstate;
+    in->stateChange = time(NULL);
+    in->idleStart = 0;
+
+    return (0);
+}
+
+//!
+//! Prepares a fan-out of per-NC child processes over resourceCacheStage[]. The
+//! parent never blocks waiting for a free slot the way it did on the old refresh
+//! semaphore: children are started up to the NC_FANOUT limit (all NCs at once by
+//! default) and reaped in whatever order they finish, each against its own
+//! deadline, so a single slow node no longer holds up the rest of the cycle.
+//!
+//! @param[out] fan the fan-out state to initialize
+//! @param[in]  num number of NCs that will be polled
+//! @param[in]  latencyOp the per-NC latency histogram to update (NCLAT_*), or -1 for none
+//!
+//! @see nc_fanout_fork(), nc_fanout_end()
+//!
+static void nc_fanout_begin(ncFanoutState * fan, int num, int latencyOp)
+{
+    bzero(fan, sizeof(ncFanoutState));
+    fan->num = num;
+    fan->latencyOp = latencyOp;
+    fan->limit = (config->ncFanout > 0) ? config->ncFanout : MAXNODES;
+    fan->timeout = NC_FANOUT_REAP_TIMEOUT;
+
+    fan->pids = EUCA_ZALLOC(MAX(num, 1), sizeof(pid_t));
+    fan->startMs = EUCA_ZALLOC(MAX(num, 1), sizeof(long long));
+    fan->termMs = EUCA_ZALLOC(MAX(num, 1), sizeof(long long));
+    fan->measured = EUCA_ZALLOC(MAX(num, 1), sizeof(boolean));
+    if (!fan->pids || !fan->startMs || !fan->termMs || !fan->measured) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
+}
+
+//!
+//! Forks the child that will poll resourceCacheStage->resources[idx]. If the
+//! fan-out limit has been reached, finished children are reaped first. The child
+//! exits through unlock_exit() when it is terminated at its deadline, so that the
+//! locks it holds (such as the NCCALL semaphore of its NC) are released.
+//!
+//! @param[in] fan the fan-out state
+//! @param[in] idx index of the NC in resourceCacheStage[]
+//! @param[in] measure set if the child will actually send a request to the NC, and its latency should be recorded
+//!
+//! @return 0 in the child, the child's PID in the parent, or -1 if no child could be started
+//!
+static pid_t nc_fanout_fork(ncFanoutState * fan, int idx, boolean measure)
+{
+    pid_t pid = 0;
+
+    while (fan->outstanding >= fan->limit) {
+        nc_fanout_reap(fan, TRUE);
+    }
+
+    fan->startMs[idx] = mono_time_ms();
+    fan->measured[idx] = measure;
+    if ((pid = fork()) < 0) {
+        LOGERROR("cannot fork child to poll node %s: %s\n", resourceCacheStage->resources[idx].hostname, strerror(errno));
+        return (-1);
+    }
+
+    if (pid > 0) {
+        fan->pids[idx] = pid;
+        fan->outstanding++;
+    } else {
+        struct sigaction newsigact = { {0} };
+
+        newsigact.sa_handler = nc_fanout_child_term;
+        sigemptyset(&newsigact.sa_mask);
+        sigaction(SIGTERM, &newsigact, NULL);
+    }
+    return (pid);
+}
+
+//!
+//! SIGTERM handler of the children of a fan-out, which are terminated at their deadline
+//!
+//! @param[in] sig the signal
+//!
+static void nc_fanout_child_term(int sig)
+{
+    unlock_exit(1);
+}
+
+//!
+//! Reaps the children of a fan-out that have exited, terminating any that ran past
+//! their deadline, and records how long each NC took. A child is never SIGKILLed,
+//! since it may hold the named semaphore of an NC: one that has not exited
+//! NC_FANOUT_TERM_GRACE seconds after SIGTERM is given up on, and left running.
+//!
+//! @param[in] fan the fan-out state
+//! @param[in] wait_for_one if TRUE, keep polling until at least one child has been reaped
+//!
+//! @return the number of children reaped
+//!
+static int nc_fanout_reap(ncFanoutState * fan, boolean wait_for_one)
+{
+    int i = 0;
+    int rc = 0;
+    int status = 0;
+    int reaped = 0;
+    pid_t pid = 0;
+    long long elapsed = 0;
+    boolean timedout = FALSE;
+
+    do {
+        for (i = 0; i < fan->num; i++) {
+            if (fan->pids[i] <= 0)
+                continue;
+
+            timedout = FALSE;
+            elapsed = mono_time_ms() - fan->startMs[i];
+            if ((pid = waitpid(fan->pids[i], &status, WNOHANG)) == 0) {
+                if (elapsed < (fan->timeout * 1000LL))
+                    continue;
+
+                if (!fan->termMs[i]) {
+                    // this NC is past its deadline, do not let it hold up the rest of the cycle
+                    LOGWARN("child pid '%d' polling node %s did not finish in %d seconds, terminating it\n", fan->pids[i],
+                            resourceCacheStage->resources[i].hostname, fan->timeout);
+                    kill(fan->pids[i], SIGTERM);
+                    fan->termMs[i] = mono_time_ms();
+                    continue;
+                }
+                if ((mono_time_ms() - fan->termMs[i]) < (NC_FANOUT_TERM_GRACE * 1000LL))
+                    continue;
+
+                LOGERROR("child pid '%d' polling node %s did not exit %d seconds after SIGTERM, giving up on it\n", fan->pids[i],
+                         resourceCacheStage->resources[i].hostname, NC_FANOUT_TERM_GRACE);
+                timedout = TRUE;
+                rc = 1;
+            } else if (pid > 0) {
+                // process exited, and wait picked it up.
+                rc = (WIFEXITED(status)) ? WEXITSTATUS(status) : 1;
+                if (fan->termMs[i]) {
+                    // exited once terminated at its deadline
+                    timedout = TRUE;
+                    rc = 1;
+                }
+            } else {
+                // process no longer exists, and someone else reaped it
+                rc = 0;
+            }
+
+            if (fan->results) {
+                // the caller makes sense of the exit codes
+                fan->results[i] = (pid < 0) ? -1 : rc;
+            } else if (rc) {
+                LOGWARN("error waiting for child pid '%d', exit code '%d'\n", fan->pids[i], rc);
+            }
+
+            if ((fan->latencyOp >= 0) && fan->measured[i]) {
+                nc_latency_record(&(resourceCacheStage->resources[i].latency[fan->latencyOp]), elapsed, timedout);
+            }
+            if (timedout && fan->measured[i]) {
+                // the child never got to record how the poll went
+                nc_health_record(&(resourceCacheStage->resources[i]), FALSE);
+            }
+
+            fan->pids[i] = 0;
+            fan->outstanding--;
+            reaped++;
+        }
+
+        if (wait_for_one && !reaped && fan->outstanding) {
+            usleep(10000);
+        }
+    } while (wait_for_one && !reaped && fan->outstanding);
+
+    return (reaped);
+}
+
+//!
+//! Waits for all the children of a fan-out to finish and releases its state.
+//!
+//! @param[in] fan the fan-out state
+//!
+static void nc_fanout_end(ncFanoutState * fan)
+{
+    int i = 0;
+    int slowest = -1;
+    long long start = 0;
+
+    while (fan->outstanding) {
+        nc_fanout_reap(fan, TRUE);
+    }
 
-            brname = NULL;
-            rc = vnetStartNetwork(vnetconfig, vlan, uuid, accountId, netName, &brname);
-            EUCA_FREE(brname);
+    if (fan->latencyOp >= 0) {
+        for (i = 0; i < fan->num; i++) {
+            if (fan->startMs[i] && (!start || (fan->startMs[i] < start)))
+                start = fan->startMs[i];
+            if (!fan->measured[i])
+                continue;
+            if (slowest < 0 || (resourceCacheStage->resources[i].latency[fan->latencyOp].lastMs > resourceCacheStage->resources[slowest].latency[fan->latencyOp].lastMs))
+                slowest = i;
         }
-        sem_mypost(VNET);
-
-        if (rc) {
-            LOGERROR("vnetStartNetwork() failed (%d)\n", rc);
-            ret = 1;
-        } else {
-            ret = 0;
+        if (slowest >= 0) {
+            LOGDEBUG("%s polled %d node(s) in %lld ms, slowest was %s (%d ms)\n", nc_latency_names[fan->latencyOp], fan->num, (start ? (mono_time_ms() - start) : 0),
+                     resourceCacheStage->resources[slowest].hostname, resourceCacheStage->resources[slowest].latency[fan->latencyOp].lastMs);
         }
-
     }
 
-    LOGTRACE("done\n");
+    EUCA_FREE(fan->pids);
+    EUCA_FREE(fan->startMs);
+    EUCA_FREE(fan->termMs);
+    EUCA_FREE(fan->measured);
+}
 
-    shawn();
+//!
+//! Adds one latency sample to a per-NC histogram.
+//!
+//! @param[in] lat the histogram to update
+//! @param[in] ms how long the request took, in milliseconds
+//! @param[in] timedout set if the request was terminated at its deadline
+//!
+static void nc_latency_record(ncLatency * lat, long long ms, boolean timedout)
+{
+    int b = 0;
+
+    for (b = 0; (b < (NC_LATENCY_BUCKETS - 1)) && (ms > nc_latency_bounds_ms[b]); b++) ;
+
+    lat->count++;
+    lat->buckets[b]++;
+    lat->lastMs = (int)ms;
+    lat->recentMs[lat->recentNext] = (int)ms;
+    lat->recentNext = (lat->recentNext + 1) % NC_LATENCY_RECENT;
+    lat->totalMs += ms;
+    if (lat->lastMs > lat->maxMs)
+        lat->maxMs = lat->lastMs;
+    if (timedout)
+        lat->timeouts++;
+}
 
-    return (ret);
+//!
+//! qsort() comparator putting latencies in ascending order
+//!
+//! @param[in] a pointer to the first latency
+//! @param[in] b pointer to the second latency
+//!
+//! @return negative, zero or positive as the first latency is lower, equal or higher
+//!
+static int nc_latency_cmp(const void *a, const void *b)
+{
+    return (*((const int *)a) - *((const int *)b));
 }
 
 //!
+//! Works out how long a request to an NC may take, from the latencies it showed lately.
+//! A node gets NC_ADAPTIVE_TIMEOUT_FACTOR times the NC_ADAPTIVE_TIMEOUT_PCT percentile
+//! of its recent requests, but never less than OP_TIMEOUT_MIN or more than the
+//! time left for the whole operation. Until enough requests were measured, the node
+//! gets all of the time left.
 //!
+//! @param[in] res the node the request goes to
+//! @param[in] latencyOp the latency histogram (NCLAT_*) of the request
+//! @param[in] timeout seconds left for the operation, as given by ncGetTimeout()
 //!
-//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
-//! @param[in]  ccvms
-//! @param[in]  vmLen
-//! @param[out] outTypesMax
-//! @param[out] outTypesAvail
-//! @param[out] outTypesLen
-//! @param[out] outNodes
-//! @param[out] outNodesLen
+//! @return the number of seconds the request may take
 //!
-//! @return
+static int nc_adaptive_timeout(ccResource * res, int latencyOp, int timeout)
+{
+    int n = 0;
+    int adaptive = 0;
+    int sorted[NC_LATENCY_RECENT] = { 0 };
+    ncLatency *lat = &(res->latency[latencyOp]);
+
+    if ((n = MIN(lat->count, NC_LATENCY_RECENT)) < (NC_LATENCY_RECENT / 2))
+        return (timeout);
+
+    memcpy(sorted, lat->recentMs, n * sizeof(int));
+    qsort(sorted, n, sizeof(int), nc_latency_cmp);
+    adaptive = ((sorted[((n - 1) * NC_ADAPTIVE_TIMEOUT_PCT) / 100] * NC_ADAPTIVE_TIMEOUT_FACTOR) + 999) / 1000;
+    return (MIN(timeout, MAX(adaptive, OP_TIMEOUT_MIN)));
+}
+
 //!
-//! @pre
+//! Tells whether a node may be polled. Nodes whose circuit is closed always may.
+//! Once the backoff of an open circuit has run out, a single poll goes out as a
+//! probe: the circuit is half-open until nc_health_record() learns how it went,
+//! and nobody else probes the node for another backoff period in the meantime.
 //!
-//! @note
+//! @param[in] res the node about to be polled
 //!
-int doDescribeResources(ncMetadata * pMeta, virtualMachine ** ccvms, int vmLen, int **outTypesMax, int **outTypesAvail, int *outTypesLen, ccResource ** outNodes, int *outNodesLen)
+//! @return TRUE if the node should be polled, FALSE if it is being left alone
+//!
+static boolean nc_health_allow(ccResource * res)
 {
-    int i;
-    int rc, diskpool, mempool, corepool;
-    int j;
-    ccResource *res;
-    ccResourceCache resourceCacheLocal;
-    LOGDEBUG("invoked: userId=%s, vmLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), vmLen);
+    time_t now = time(NULL);
+    ncHealth *health = &(res->health);
 
-    rc = initialize(pMeta, FALSE);
-    if (rc || ccIsEnabled()) {
-        return (1);
-    }
+    if (health->state == NCHEALTH_CLOSED)
+        return (TRUE);
 
-    if (outTypesMax == NULL || outTypesAvail == NULL || outTypesLen == NULL || outNodes == NULL || outNodesLen == NULL) {
-        // input error
-        return (1);
+    if (now < health->retryAt) {
+        LOGDEBUG("circuit of node %s is open, next probe in %ld seconds\n", res->hostname, (long)(health->retryAt - now));
+        return (FALSE);
     }
 
-    *outTypesMax = NULL;
-    *outTypesAvail = NULL;
-
-    *outTypesMax = EUCA_ZALLOC(vmLen, sizeof(int));
-    *outTypesAvail = EUCA_ZALLOC(vmLen, sizeof(int));
-    if (*outTypesMax == NULL || *outTypesAvail == NULL) {
-        LOGERROR("out of memory\n");
-        unlock_exit(1);
-    }
+    LOGDEBUG("probing node %s after %d consecutive failures\n", res->hostname, health->failures);
+    health->state = NCHEALTH_HALF_OPEN;
+    health->retryAt = now + health->backoff;
+    return (TRUE);
+}
 
-    *outTypesLen = vmLen;
+//!
+//! Records how a poll of a node went. A success closes the circuit. A failed probe
+//! opens it again for twice as long, up to NC_BREAKER_BACKOFF_MAX, and the circuit
+//! of a healthy node opens after NC_BREAKER_FAILURES failures in a row.
+//!
+//! @param[in] res the node that was polled
+//! @param[in] ok set if the node answered
+//!
+static void nc_health_record(ccResource * res, boolean ok)
+{
+    ncHealth *health = &(res->health);
 
-    for (i = 0; i < vmLen; i++) {
-        if ((*ccvms)[i].mem <= 0 || (*ccvms)[i].cores <= 0 || (*ccvms)[i].disk <= 0) {
-            LOGERROR("input error\n");
-            EUCA_FREE(*outTypesAvail);
-            EUCA_FREE(*outTypesMax);
-            *outTypesLen = 0;
-            return (1);
+    if (ok) {
+        if (health->state != NCHEALTH_CLOSED) {
+            LOGINFO("node %s is answering again, resuming its polling\n", res->hostname);
         }
+        health->state = NCHEALTH_CLOSED;
+        health->failures = 0;
+        health->backoff = NC_BREAKER_BACKOFF_MIN;
+        return;
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-    {
-        *outNodes = EUCA_ZALLOC(resourceCacheLocal.numResources, sizeof(ccResource));
-        if (*outNodes == NULL) {
-            LOGFATAL("out of memory!\n");
-            unlock_exit(1);
-        } else {
-            memcpy(*outNodes, resourceCacheLocal.resources, sizeof(ccResource) * resourceCacheLocal.numResources);
-            *outNodesLen = resourceCacheLocal.numResources;
-        }
+    health->failures++;
+    if (health->state == NCHEALTH_HALF_OPEN) {
+        health->backoff = MIN((health->backoff * 2), NC_BREAKER_BACKOFF_MAX);
+    } else if ((health->state == NCHEALTH_OPEN) || (health->failures < NC_BREAKER_FAILURES)) {
+        return;
+    } else {
+        health->backoff = NC_BREAKER_BACKOFF_MIN;
+        health->trips++;
+    }
 
-        for (i = 0; i < resourceCacheLocal.numResources; i++) {
-            res = &(resourceCacheLocal.resources[i]);
-            for (j = 0; j < vmLen; j++) {
-                if (res->ncState == STOPPED) {
-                    mempool = 0;
-                    diskpool = 0;
-                    corepool = 0;
-                } else {
-                    mempool = res->availMemory;
-                    diskpool = res->availDisk;
-                    corepool = res->availCores;
-                }
+    LOGWARN("node %s failed %d polls in a row, leaving it alone for %d seconds\n", res->hostname, health->failures, health->backoff);
+    health->state = NCHEALTH_OPEN;
+    health->retryAt = time(NULL) + health->backoff;
+}
 
-                mempool -= (*ccvms)[j].mem;
-                diskpool -= (*ccvms)[j].disk;
-                corepool -= (*ccvms)[j].cores;
-                while (mempool >= 0 && diskpool >= 0 && corepool >= 0) {
-                    (*outTypesAvail)[j]++;
-                    mempool -= (*ccvms)[j].mem;
-                    diskpool -= (*ccvms)[j].disk;
-                    corepool -= (*ccvms)[j].cores;
-                }
+//!
+//! Tells whether a node is due for a poll. The refreshes run every ncPollingMin seconds and
+//! each node is only polled once its own interval has gone by since its last poll, give or
+//! take the second by which a refresh may start past its period.
+//!
+//! @param[in] res the node about to be polled
+//! @param[in] lastPoll when the refresh last polled the node
+//!
+//! @return TRUE if the node should be polled by this refresh
+//!
+static boolean nc_poll_due(ccResource * res, time_t lastPoll)
+{
+    return (((time(NULL) - lastPoll) + 1) >= MAX(res->pollInterval, config->ncPollingMin));
+}
 
-                if (res->ncState == STOPPED) {
-                    mempool = 0;
-                    diskpool = 0;
-                    corepool = 0;
-                } else {
-                    mempool = res->maxMemory;
-                    diskpool = res->maxDisk;
-                    corepool = res->maxCores;
-                }
+//!
+//! Adapts the polling interval of a node to what its instances are doing: a node with
+//! instances in transition is polled every ncPollingMin seconds, a stable one less and
+//! less often, NC_POLL_GROWTH times longer after every stable reply, up to ncPollingMax.
+//!
+//! @param[in] res the node that was polled
+//! @param[in] busy set if the node has instances in transition or did not answer
+//!
+static void nc_poll_adapt(ccResource * res, boolean busy)
+{
+    time_t interval = 0;
 
-                mempool -= (*ccvms)[j].mem;
-                diskpool -= (*ccvms)[j].disk;
-                corepool -= (*ccvms)[j].cores;
-                while (mempool >= 0 && diskpool >= 0 && corepool >= 0) {
-                    (*outTypesMax)[j]++;
-                    mempool -= (*ccvms)[j].mem;
-                    diskpool -= (*ccvms)[j].disk;
-                    corepool -= (*ccvms)[j].cores;
-                }
-            }
-        }
+    if (busy) {
+        interval = config->ncPollingMin;
+    } else {
+        interval = MIN((MAX(res->pollInterval, config->ncPollingMin) * NC_POLL_GROWTH), config->ncPollingMax);
     }
 
-    if (vmLen >= 5) {
-        LOGDEBUG("resources summary ({avail/max}): %s{%d/%d} %s{%d/%d} %s{%d/%d} %s{%d/%d} %s{%d/%d}\n", (*ccvms)[0].name,
-                 (*outTypesAvail)[0], (*outTypesMax)[0], (*ccvms)[1].name, (*outTypesAvail)[1], (*outTypesMax)[1], (*ccvms)[2].name,
-                 (*outTypesAvail)[2], (*outTypesMax)[2], (*ccvms)[3].name, (*outTypesAvail)[3], (*outTypesMax)[3], (*ccvms)[4].name, (*outTypesAvail)[4], (*outTypesMax)[4]);
+    if (interval != res->pollInterval) {
+        LOGTRACE("polling node %s every %ld seconds\n", res->hostname, (long)interval);
+        res->pollInterval = interval;
     }
+}
 
-    LOGTRACE("done\n");
+//!
+//! Has a node polled on the next refresh and at the shortest interval after that, for nodes
+//! that were just asked to start or stop instances. The caller must hold RESCACHE.
+//!
+//! @param[in] res the node in resourceCache
+//!
+static void nc_poll_hurry(ccResource * res)
+{
+    res->pollInterval = config->ncPollingMin;
+    res->lastResPoll = 0;
+    res->lastInstPoll = 0;
+}
 
-    shawn();
+//!
+//! Tells whether an instance is in one of the states that keep its node polled at the
+//! shortest interval
+//!
+//! @param[in] state the state of the instance as reported to the CLC
+//! @param[in] migration_state the migration state of the instance
+//!
+//! @return TRUE if the instance is pending or migrating
+//!
+static boolean instance_in_transition(const char *state, migration_states migration_state)
+{
+    return (!strcmp(state, "Pending") || (migration_state != NOT_MIGRATING));
+}
 
-    return (0);
+//!
+//! Logs the latency histograms of a node: at INFO level if its last refresh
+//! was slow or timed out, and at DEBUG level otherwise.
+//!
+//! @param[in] res the node to report on
+//!
+static void print_ncLatency(ccResource * res)
+{
+    int op = 0;
+    int b = 0;
+    int len = 0;
+    char hist[256] = "";
+    ncLatency *lat = NULL;
+
+    if (res->health.state != NCHEALTH_CLOSED) {
+        LOGINFO("isolated node %s: %d consecutive failures, circuit opened %d time(s), next probe in %ld seconds\n", res->hostname, res->health.failures,
+                res->health.trips, (long)MAX(0, res->health.retryAt - time(NULL)));
+    }
+
+    for (op = 0; op < NCLAT_LAST; op++) {
+        lat = &(res->latency[op]);
+        if (lat->count == 0)
+            continue;
+
+        for (b = 0, len = 0; (b < NC_LATENCY_BUCKETS) && (len < sizeof(hist)); b++) {
+            if (b < (NC_LATENCY_BUCKETS - 1)) {
+                len += snprintf(hist + len, sizeof(hist) - len, "%s<%d:%d", (b ? " " : ""), nc_latency_bounds_ms[b], lat->buckets[b]);
+            } else {
+                len += snprintf(hist + len, sizeof(hist) - len, " >%d:%d", nc_latency_bounds_ms[b - 1], lat->buckets[b]);
+            }
+        }
+
+        if (lat->lastMs > NC_LATENCY_SLOW_MS) {
+            LOGINFO("slow node %s: %s last=%dms mean=%lldms max=%dms timeouts=%d [%s]\n", res->hostname, nc_latency_names[op], lat->lastMs, (lat->totalMs / lat->count),
+                    lat->maxMs, lat->timeouts, hist);
+        } else {
+            LOGDEBUG("node %s: %s last=%dms mean=%lldms max=%dms timeouts=%d [%s]\n", res->hostname, nc_latency_names[op], lat->lastMs, (lat->totalMs / lat->count),
+                     lat->maxMs, lat->timeouts, hist);
+        }
+    }
 }
 
 //!
+//! Finds the slot of an NC in ncNetworkInfoAcks[], taking a free one for an NC not seen before
 //!
+//! @param[in] ncURL the URL of the NC
 //!
-//! @param[in] in
-//! @param[in] newstate
+//! @return the slot or -1 if the table is full
 //!
-//! @return
+static int ncNetworkInfoAckSlot(const char *ncURL)
+{
+    int i = 0;
+    int slot = -1;
+
+    for (i = 0; i < MAXNODES; i++) {
+        if (ncNetworkInfoAcks[i].ncURL[0] == '\0') {
+            if (slot < 0)
+                slot = i;
+        } else if (!strcmp(ncNetworkInfoAcks[i].ncURL, ncURL)) {
+            return (i);
+        }
+    }
+
+    if (slot >= 0) {
+        bzero(&(ncNetworkInfoAcks[slot]), sizeof(ncNetworkInfoAcks[slot]));
+        euca_strncpy(ncNetworkInfoAcks[slot].ncURL, ncURL, sizeof(ncNetworkInfoAcks[slot].ncURL));
+    }
+    return (slot);
+}
+
 //!
-//! @pre
+//! Builds the compressed form of the network info, see NETWORK_INFO_ZLIB_PREFIX
 //!
-//! @note
+//! @param[in] xml the network info XML
+//! @param[in] version the MD5 of the XML
 //!
-int changeState(ccResource * in, int newstate)
+//! @return the compressed form, to be freed by the caller, or NULL if it cannot be built
+//!
+static char *pack_network_info(const char *xml, const char *version)
 {
-    if (in == NULL)
-        return (1);
-    if (in->state == newstate)
-        return (0);
+#if defined(HAVE_ZLIB_H)
+    int rc = 0;
+    char *b64 = NULL;
+    char *packed = NULL;
+    Bytef *zbuf = NULL;
+    uLong len = strlen(xml);
+    uLongf zlen = compressBound(len);
 
-    in->lastState = in->state;
-    in->state = newstate;
-    in->stateChange = time(NULL);
-    in->idleStart = 0;
+    if ((zbuf = EUCA_ALLOC(zlen, sizeof(Bytef))) == NULL)
+        return (NULL);
 
-    return (0);
+    if ((rc = compress2(zbuf, &zlen, ((const Bytef *)xml), len, Z_BEST_SPEED)) != Z_OK) {
+        LOGWARN("cannot compress the network info (%d), sending it as is\n", rc);
+    } else if ((b64 = base64_enc(zbuf, zlen)) != NULL) {
+        if ((packed = EUCA_ALLOC((strlen(b64) + 128), sizeof(char))) != NULL) {
+            sprintf(packed, NETWORK_INFO_ZLIB_PREFIX "%s:%lu:%s", version, (unsigned long)len, b64);
+            LOGDEBUG("network info %s is %lu bytes, %lu compressed\n", version, (unsigned long)len, (unsigned long)zlen);
+        }
+    }
+
+    EUCA_FREE(b64);
+    EUCA_FREE(zbuf);
+    return (packed);
+#else /* HAVE_ZLIB_H */
+    return (NULL);
+#endif /* HAVE_ZLIB_H */
 }
 
+//!
+//! Sends the global network info to the NCs. An NC known to have its current version only gets
+//! a version token, which it checks against the XML it has. The others, and the ones whose check
+//! fails, get the compressed form, or the plain base64 XML if they turn that down.
+//!
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in] timeout the timeout of the calls to each NC, in seconds
+//! @param[in] dolock unused
+//!
+//! @return 0 on success or 1 on failure
+//!
 int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
 {
     int i = 0;
     int rc = 0;
     int pid = 0;
-    int *pids = NULL;
-    int status = 0;
+    int slot = 0;
+    int current = 0;
+    int *slots = NULL;
+    int *results = NULL;
     time_t op_start = { 0 };
+    char *xml = NULL;
+    char *packed = NULL;
     char *networkInfo = NULL;
+    char version[NETWORK_INFO_VERSION_LEN] = "";
+    char token[NETWORK_INFO_VERSION_LEN + 16] = "";
+    ncFanoutState fan = { 0 };
 
     if (timeout <= 0)
         timeout = 1;
 
-    op_start = time(NULL);
+    op_start = mono_time_sec();
     LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
 
     // critical NC call section
@@ -2424,65 +3735,93 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
     memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
     sem_mypost(RESCACHE);
 
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
     // here is where we will convert the globalnetworkinfo into the broadcast string
     sem_mywait(GLOBALNETWORKINFO);
     networkInfo = strdup(globalnetworkinfo->networkInfo);
     sem_mypost(GLOBALNETWORKINFO);
 
+    if (!networkInfo || (networkInfo[0] == '\0')) {
+        EUCA_FREE(networkInfo);
+        return (1);
+    }
+
+    // the version is the MD5 of the XML, which is what the NCs can check their copy against
+    if (((xml = base64_dec((unsigned char *)networkInfo, strlen(networkInfo))) != NULL) && (str2md5str(version, sizeof(version), xml) == EUCA_OK)) {
+        snprintf(token, sizeof(token), NETWORK_INFO_VERSION_PREFIX "%s", version);
+        packed = pack_network_info(xml, version);
+    } else {
+        LOGWARN("cannot tell the version of the network info, broadcasting it as is\n");
+        version[0] = '\0';
+    }
+    EUCA_FREE(xml);
+
+    results = EUCA_ZALLOC(MAX(resourceCacheStage->numResources, 1), sizeof(int));
+    slots = EUCA_ZALLOC(MAX(resourceCacheStage->numResources, 1), sizeof(int));
+    if (!results || !slots) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(results);
+        EUCA_FREE(slots);
+        EUCA_FREE(packed);
+        EUCA_FREE(networkInfo);
+        return (1);
+    }
+
+    nc_fanout_begin(&fan, resourceCacheStage->numResources, -1);
+    fan.results = results;
     for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
+        slots[i] = slot = ncNetworkInfoAckSlot(resourceCacheStage->resources[i].ncURL);
+        current += ((slot >= 0) && version[0] && !strcmp(ncNetworkInfoAcks[slot].version, version));
 
-        pid = fork();
+        pid = nc_fanout_fork(&fan, i, FALSE);
         if (!pid) {
-            // do the broadcast
-            rc = ncClientCall(pMeta, 0, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL, "ncBroadcastNetworkInfo", networkInfo);
+            ccResource *res = &(resourceCacheStage->resources[i]);
 
-            if (rc != 0) {
-                LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", resourceCacheStage->resources[i].hostname, rc);
+            // an NC said to have this version only has to confirm it
+            if ((slot >= 0) && version[0] && !strcmp(ncNetworkInfoAcks[slot].version, version)) {
+                if ((rc = ncClientCall(pMeta, timeout, res->lockidx, res->ncURL, NC_OP_BROADCAST_NETWORK_INFO, token)) == 0)
+                    exit(NETINFO_CURRENT);
+                LOGDEBUG("node %s does not have network info %s, sending it\n", res->hostname, version);
             }
 
-            sem_mypost(REFRESHLOCK);
-            exit(0);
-        } else {
-            pids[i] = pid;
+            if (packed && ((slot < 0) || !ncNetworkInfoAcks[slot].plain)) {
+                if ((rc = ncClientCall(pMeta, timeout, res->lockidx, res->ncURL, NC_OP_BROADCAST_NETWORK_INFO, packed)) == 0)
+                    exit(NETINFO_CURRENT);
+                LOGDEBUG("node %s turned down the compressed network info, sending it as is\n", res->hostname);
+                if ((rc = ncClientCall(pMeta, timeout, res->lockidx, res->ncURL, NC_OP_BROADCAST_NETWORK_INFO, networkInfo)) == 0)
+                    exit(NETINFO_PLAIN);
+            } else {
+                if ((rc = ncClientCall(pMeta, timeout, res->lockidx, res->ncURL, NC_OP_BROADCAST_NETWORK_INFO, networkInfo)) == 0)
+                    exit(NETINFO_CURRENT);
+            }
+
+            LOGERROR("bad return from ncBroadcastNetworkInfo(%s) (%d)\n", res->hostname, rc);
+            exit(NETINFO_FAILED);
         }
     }
 
-    // free the broadcast string
-    EUCA_FREE(networkInfo);
+    nc_fanout_end(&fan);
 
+    // what each NC has now decides what it gets the next time around
     for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
+        if ((slot = slots[i]) < 0)
+            continue;
+
+        if ((results[i] == NETINFO_CURRENT) || (results[i] == NETINFO_PLAIN)) {
+            euca_strncpy(ncNetworkInfoAcks[slot].version, version, sizeof(ncNetworkInfoAcks[slot].version));
+            ncNetworkInfoAcks[slot].plain = (results[i] == NETINFO_PLAIN);
         } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
+            ncNetworkInfoAcks[slot].version[0] = '\0';
         }
     }
 
-    EUCA_FREE(pids);
+    LOGDEBUG("broadcast network info %s to %d node(s) in %ld seconds, %d of them only needed the version\n", (version[0] ? version : "(unversioned)"),
+             resourceCacheStage->numResources, (long)(mono_time_sec() - op_start), current);
+
+    EUCA_FREE(slots);
+    EUCA_FREE(results);
+    EUCA_FREE(packed);
+    EUCA_FREE(networkInfo);
+
     LOGTRACE("done\n");
     return (0);
 }
@@ -2502,15 +3841,16 @@ int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock)
 //!
 int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
 {
-    int i, rc, nctimeout, pid, *pids = NULL;
-    int status;
+    int i, rc, nctimeout, pid;
+    boolean poll = FALSE;
     time_t op_start;
     ncResource *ncResDst = NULL;
+    ncFanoutState fan = { 0 };
 
     if (timeout <= 0)
         timeout = 1;
 
-    op_start = time(NULL);
+    op_start = mono_time_sec();
     LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
 
     // critical NC call section
@@ -2518,26 +3858,22 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
     memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
     sem_mypost(RESCACHE);
 
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
+    nc_fanout_begin(&fan, resourceCacheStage->numResources, NCLAT_DESCRIBE_RESOURCE);
 
     for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-
-        pid = fork();
+        poll = ((resourceCacheStage->resources[i].state != RESASLEEP) && (resourceCacheStage->resources[i].running == 0));
+        poll = (poll && nc_poll_due(&(resourceCacheStage->resources[i]), resourceCacheStage->resources[i].lastResPoll));
+        poll = (poll && nc_health_allow(&(resourceCacheStage->resources[i])));
+        if (poll)
+            resourceCacheStage->resources[i].lastResPoll = time(NULL);
+        pid = nc_fanout_fork(&fan, i, poll);
         if (!pid) {
             ncResDst = NULL;
-            if (resourceCacheStage->resources[i].state != RESASLEEP && resourceCacheStage->resources[i].running == 0) {
-                nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
+            if (poll) {
+                nctimeout = nc_adaptive_timeout(&(resourceCacheStage->resources[i]), NCLAT_DESCRIBE_RESOURCE, ncGetTimeout(op_start, timeout, 1, 1));
                 char *errMsg = NULL;
                 rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                  "ncDescribeResource", NULL, &ncResDst, &errMsg);
+                                  NC_OP_DESCRIBE_RESOURCE, NULL, &ncResDst, &errMsg);
                 if (rc != 0) {
                     powerUp(&(resourceCacheStage->resources[i]));
 
@@ -2546,6 +3882,8 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
                                  config->wakeThresh - (time(NULL) - resourceCacheStage->resources[i].stateChange));
                     } else {
                         LOGERROR("bad return from ncDescribeResource(%s) (%d)\n", resourceCacheStage->resources[i].hostname, rc);
+                        nc_health_record(&(resourceCacheStage->resources[i]), FALSE);
+                        nc_poll_adapt(&(resourceCacheStage->resources[i]), TRUE);
                         resourceCacheStage->resources[i].maxMemory = 0;
                         resourceCacheStage->resources[i].availMemory = 0;
                         resourceCacheStage->resources[i].maxDisk = 0;
@@ -2588,10 +3926,15 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
                         euca_strncpy(resourceCacheStage->resources[i].hypervisor, ncResDst->hypervisor, 16);
                     }
                     changeState(&(resourceCacheStage->resources[i]), RESUP);
+                    nc_health_record(&(resourceCacheStage->resources[i]), TRUE);
                 }
                 if (errMsg != NULL) {
                     EUCA_FREE(errMsg);
                 }
+            } else if (resourceCacheStage->resources[i].health.state != NCHEALTH_CLOSED) {
+                // an isolated node takes no new work until a probe gets through
+                if (resourceCacheStage->resources[i].state == RESUP)
+                    changeState(&(resourceCacheStage->resources[i]), RESDOWN);
             } else {
                 LOGDEBUG("resource asleep/running instances (%d), skipping resource update\n", resourceCacheStage->resources[i].running);
             }
@@ -2609,35 +3952,11 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
             }
 
             EUCA_FREE(ncResDst);
-            sem_mypost(REFRESHLOCK);
             exit(0);
-        } else {
-            pids[i] = pid;
         }
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
-        }
-    }
+    nc_fanout_end(&fan);
 
     // resourceCacheStage[] entries were updated based on replies from NC,
     // so merge them into the canonical location: resourceCache[] (no
@@ -2645,7 +3964,6 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock)
     // does not change as part of the update)
     refresh_resourceCache(resourceCacheStage, FALSE);
 
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 }
@@ -2745,13 +4063,147 @@ static int migration_handler(ccInstance * myInstance, char *host, char *src, cha
             LOGDEBUG("[%s] ignoring update from destination node %s during migration: %s(%s)\n", myInstance->instanceId, host, myInstance->state,
                      migration_state_names[myInstance->migration_state]);
         }
-    } else if (!strcmp(host, src)) {
-        LOGDEBUG("[%s] received state %s(%s) from source node %s\n", myInstance->instanceId, myInstance->state, migration_state_names[migration_state], host);
-    } else {
-        LOGERROR("[%s] received status from a migrating node that's neither the source (%s) nor the destination (%s): %s\n", myInstance->instanceId, src, dst, host);
+    } else if (!strcmp(host, src)) {
+        LOGDEBUG("[%s] received state %s(%s) from source node %s\n", myInstance->instanceId, myInstance->state, migration_state_names[migration_state], host);
+    } else {
+        LOGERROR("[%s] received status from a migrating node that's neither the source (%s) nor the destination (%s): %s\n", myInstance->instanceId, src, dst, host);
+    }
+    LOGDEBUG("done\n");
+    return (rc);
+}
+
+//!
+//! Takes (or gives back) the capacity of a node for instances that are migrating to it, so that
+//! the rest of a batch is placed knowing about them. The node's next report replaces the figures.
+//!
+//! @param[in] resid index of the destination node in the resource cache
+//! @param[in] vm    type of the migrating instance
+//! @param[in] count 1 to take the capacity, -1 to give it back
+//!
+//! @note this must be called with RESCACHE lock held, see sem_mywait()
+//!
+static void reserve_migration_capacity(int resid, virtualMachine * vm, int count)
+{
+    ccResource *res = NULL;
+
+    if ((resid < 0) || (resid >= resourceCache->numResources))
+        return;
+
+    res = &(resourceCache->resources[resid]);
+    res->availMemory -= (count * vm->mem);
+    res->availDisk -= (count * vm->disk);
+    res->availCores -= (count * vm->cores);
+    count_resourceCacheNode(resid);
+}
+
+//!
+//! Decides whether a migration may be committed now, given how many migrations its source and
+//! destination already run. If so, the instance is marked as migrating in the instance cache
+//! right away, so that the polls of other destination nodes count it too.
+//!
+//! @param[in] instanceId the migrating instance
+//! @param[in] src        the migration source node
+//! @param[in] dst        the migration destination node
+//!
+//! @return TRUE if the commit may be sent or FALSE if it has to wait for another migration to finish
+//!
+//! @see release_migration_commit()
+//!
+static boolean reserve_migration_commit(char *instanceId, char *src, char *dst)
+{
+    int i = 0;
+    int slot = -1;
+    int outgoing = 0;
+    int incoming = 0;
+    boolean allowed = FALSE;
+
+    sem_mywait(INSTCACHE);
+    slot = instanceCacheIndexFind(INSTIDX_ID, instanceId);
+    for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
+        if ((i != slot) && (instanceCache->cacheState[i] == INSTVALID) && (instanceCache->summaries[i].migration_state == MIGRATION_IN_PROGRESS)) {
+            outgoing += (strcmp(instanceCache->instances[i].migration_src, src) == 0);
+            incoming += (strcmp(instanceCache->instances[i].migration_dst, dst) == 0);
+        }
+    }
+
+    allowed = (((config->migrationMaxPerSource == 0) || (outgoing < config->migrationMaxPerSource))
+               && ((config->migrationMaxPerDest == 0) || (incoming < config->migrationMaxPerDest)));
+    if (allowed && (slot >= 0)) {
+        instanceCache->instances[slot].migration_state = MIGRATION_IN_PROGRESS;
+        instanceCache->summaries[slot].migration_state = MIGRATION_IN_PROGRESS;
+        instanceCache->lastchanged[slot] = time(NULL);
+        checkpoint_journal_slot(slot);
+    }
+    sem_mypost(INSTCACHE);
+
+    if (!allowed) {
+        LOGINFO("[%s] deferring migration %s > %s: %d outgoing from source (max %d), %d incoming to destination (max %d)\n", instanceId, src, dst, outgoing,
+                config->migrationMaxPerSource, incoming, config->migrationMaxPerDest);
+    }
+    return (allowed);
+}
+
+//!
+//! Puts an instance whose commit could not be sent back to ready in the instance cache
+//!
+//! @param[in] instanceId the migrating instance
+//!
+//! @see reserve_migration_commit()
+//!
+static void release_migration_commit(char *instanceId)
+{
+    int i = 0;
+
+    sem_mywait(INSTCACHE);
+    if (((i = instanceCacheIndexFind(INSTIDX_ID, instanceId)) >= 0) && (instanceCache->summaries[i].migration_state == MIGRATION_IN_PROGRESS)) {
+        instanceCache->instances[i].migration_state = MIGRATION_READY;
+        instanceCache->summaries[i].migration_state = MIGRATION_READY;
+        instanceCache->lastchanged[i] = time(NULL);
+        checkpoint_journal_slot(i);
+    }
+    sem_mypost(INSTCACHE);
+}
+
+//!
+//! Logs, for each node that has instances migrating away, how far along their migrations are
+//!
+static void print_migration_progress(void)
+{
+    int i = 0;
+    int idx = 0;
+    int counts[MAXNODES][3] = { {0} };
+
+    sem_mywait(INSTCACHE);
+    for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
+        if (instanceCache->cacheState[i] != INSTVALID)
+            continue;
+
+        idx = instanceCache->summaries[i].ncHostIdx;
+        if ((idx < 0) || (idx >= MAXNODES))
+            continue;
+
+        switch (instanceCache->summaries[i].migration_state) {
+        case MIGRATION_PREPARING:
+            counts[idx][0]++;
+            break;
+        case MIGRATION_READY:
+            counts[idx][1]++;
+            break;
+        case MIGRATION_IN_PROGRESS:
+            counts[idx][2]++;
+            break;
+        default:
+            break;
+        }
+    }
+    sem_mypost(INSTCACHE);
+
+    for (idx = 0; idx < resourceCacheStage->numResources; idx++) {
+        if (counts[idx][0] || counts[idx][1] || counts[idx][2]) {
+            LOGINFO("migrations from node %s: %d preparing, %d ready, %d in progress\n", resourceCacheStage->resources[idx].hostname, counts[idx][0], counts[idx][1],
+                    counts[idx][2]);
+        }
     }
-    LOGDEBUG("done\n");
-    return (rc);
 }
 
 //!
@@ -2770,15 +4222,17 @@ static int migration_handler(ccInstance * myInstance, char *host, char *src, cha
 int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
 {
     ccInstance *myInstance = NULL;
-    int i, numInsts = 0, found, ncOutInstsLen, rc, pid, nctimeout, *pids = NULL, status;
+    int i, numInsts = 0, found, ncOutInstsLen, rc, pid, nctimeout;
+    boolean poll = FALSE;
     time_t op_start;
-    char *migration_host = NULL;
-    char *migration_instance = NULL;
-    char *migration_action = NULL;
+    int numActions = 0;
+    migrationAction pending = { 0 };
+    migrationAction *actions = NULL;
+    ncFanoutState fan = { 0 };
 
     ncInstance **ncOutInsts = NULL;
 
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
     set_clean_instanceCache();
@@ -2788,31 +4242,49 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
     memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
     sem_mypost(RESCACHE);
 
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
+    EUCA_PROBE1(refresh__instances__start, resourceCacheStage->numResources);
+    nc_fanout_begin(&fan, resourceCacheStage->numResources, NCLAT_DESCRIBE_INSTANCES);
 
     invalidate_instanceCache();
 
     for (i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-        pid = fork();
+        poll = ((resourceCacheStage->resources[i].state == RESUP) && nc_poll_due(&(resourceCacheStage->resources[i]), resourceCacheStage->resources[i].lastInstPoll));
+        poll = (poll && nc_health_allow(&(resourceCacheStage->resources[i])));
+        if (poll)
+            resourceCacheStage->resources[i].lastInstPoll = time(NULL);
+        pid = nc_fanout_fork(&fan, i, poll);
         if (!pid) {
-            if (resourceCacheStage->resources[i].state == RESUP) {
+            if (poll) {
                 int j;
+                boolean migrating = FALSE;
+                boolean transitional = FALSE;
+                boolean busy = FALSE;
+                int unchangedIdsLen = 0;
+                char **unchangedIds = NULL;
+                long long sinceGeneration = 0;
+                long long generation = 0;
+
+                // only ask for the instances that changed since the last reply, with a periodic full resync
+                if ((time(NULL) - resourceCacheStage->resources[i].instLastFullSync) < NC_DESCRIBE_FULL_RESYNC_SEC) {
+                    sinceGeneration = resourceCacheStage->resources[i].instGeneration;
+                }
 
-                nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
+                nctimeout = nc_adaptive_timeout(&(resourceCacheStage->resources[i]), NCLAT_DESCRIBE_INSTANCES, ncGetTimeout(op_start, timeout, 1, 1));
                 rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                  "ncDescribeInstances", NULL, 0, &ncOutInsts, &ncOutInstsLen);
+                                  NC_OP_DESCRIBE_INSTANCES_DELTA, sinceGeneration, &ncOutInsts, &ncOutInstsLen, &unchangedIds, &unchangedIdsLen, &generation);
+                nc_health_record(&(resourceCacheStage->resources[i]), (rc == 0));
                 if (!rc) {
+                    LOGDEBUG("node %s reported %d changed and %d unchanged instance(s) since generation %lld\n", resourceCacheStage->resources[i].hostname,
+                             ncOutInstsLen, unchangedIdsLen, sinceGeneration);
+
+                    // instances that changed since the last poll, rather than in a full update, are in transition
+                    busy = (sinceGeneration && (ncOutInstsLen > 0));
+                    for (j = 0; !busy && (j < ncOutInstsLen); j++) {
+                        busy = instance_in_transition(ncOutInsts[j]->stateName, ncOutInsts[j]->migration_state);
+                    }
 
                     // if idle, power down
-                    if (ncOutInstsLen == 0) {
+                    if ((ncOutInstsLen + unchangedIdsLen) == 0) {
                         LOGDEBUG("node %s idle since %ld: (%ld/%d) seconds\n", resourceCacheStage->resources[i].hostname,
                                  resourceCacheStage->resources[i].idleStart, time(NULL) - resourceCacheStage->resources[i].idleStart, config->idleThresh);
                         if (!resourceCacheStage->resources[i].idleStart) {
@@ -2828,6 +4300,17 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
                         resourceCacheStage->resources[i].idleStart = 0;
                     }
 
+                    // instances that did not change only need to be marked as seen,
+                    // if one is missing from the cache, fall back to a full update
+                    for (j = 0; j < unchangedIdsLen; j++) {
+                        if (touch_instanceCache(unchangedIds[j], &transitional)) {
+                            LOGDEBUG("unchanged instance %s reported by node %s is not cached, requesting full update\n", unchangedIds[j],
+                                     resourceCacheStage->resources[i].hostname);
+                            generation = 0;
+                        }
+                        busy = (busy || transitional);
+                    }
+
                     // populate instanceCache
                     for (j = 0; j < ncOutInstsLen; j++) {
                         found = 1;
@@ -2852,15 +4335,30 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
                             // migration-related logic
                             if (ncOutInsts[j]->migration_state != NOT_MIGRATING) {
 
+                                bzero(&pending, sizeof(pending));
                                 rc = migration_handler(myInstance,
                                                        resourceCacheStage->resources[i].hostname,
                                                        ncOutInsts[j]->migration_src,
-                                                       ncOutInsts[j]->migration_dst, ncOutInsts[j]->migration_state, &migration_host, &migration_instance, &migration_action);
+                                                       ncOutInsts[j]->migration_dst, ncOutInsts[j]->migration_state, &pending.node, &pending.instance, &pending.action);
+
+                                // every migration reported by this node gets its action, not just the last one
+                                if (pending.node) {
+                                    actions = EUCA_REALLOC(actions, (numActions + 1), sizeof(migrationAction));
+                                    if (!actions) {
+                                        LOGFATAL("out of memory!\n");
+                                        unlock_exit(1);
+                                    }
+                                    actions[numActions++] = pending;
+                                } else {
+                                    EUCA_FREE(pending.instance);
+                                    EUCA_FREE(pending.action);
+                                }
 
                                 // For now just ignore updates from destination while migrating.
                                 if (!strcmp(resourceCacheStage->resources[i].hostname, ncOutInsts[j]->migration_dst)) {
                                     LOGTRACE("[%s] ignoring update from destination node %s during migration (host=%s, instance=%s, action=%s)\n",
-                                             myInstance->instanceId, ncOutInsts[j]->migration_dst, SP(migration_host), SP(migration_instance), SP(migration_action));
+                                             myInstance->instanceId, ncOutInsts[j]->migration_dst, SP(pending.node), SP(pending.instance), SP(pending.action));
+                                    migrating = TRUE;
                                     EUCA_FREE(myInstance);
                                     continue;
                                 }
@@ -2899,7 +4397,7 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
                                 // CC has network info, NC does not
                                 LOGDEBUG("sending ncAssignAddress to sync NC\n");
                                 rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                                  "ncAssignAddress", myInstance->instanceId, myInstance->ccnet.publicIp);
+                                                  NC_OP_ASSIGN_ADDRESS, myInstance->instanceId, myInstance->ccnet.publicIp);
                                 if (rc) {
                                     // problem, but will retry next time
                                     LOGWARN("could not send AssignAddress to NC\n");
@@ -2922,68 +4420,67 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
 
                     }
                 }
+
+                // a destination only reports a waiting migration once, keep asking for it until an action was sent
+                if (migrating) {
+                    generation = 0;
+                }
+                // remember where this node's instance list is at, a zero generation forces a full update next time
+                resourceCacheStage->resources[i].instGeneration = (rc) ? 0 : generation;
+                nc_poll_adapt(&(resourceCacheStage->resources[i]), (busy || migrating || (rc != 0)));
+                if (!rc && !sinceGeneration) {
+                    resourceCacheStage->resources[i].instLastFullSync = time(NULL);
+                }
+
                 if (ncOutInsts) {
                     for (j = 0; j < ncOutInstsLen; j++) {
                         free_instance(&(ncOutInsts[j]));
                     }
                     EUCA_FREE(ncOutInsts);
                 }
+                for (j = 0; j < unchangedIdsLen; j++) {
+                    EUCA_FREE(unchangedIds[j]);
+                }
+                EUCA_FREE(unchangedIds);
             }
-            sem_mypost(REFRESHLOCK);
 
-            if (migration_host) {
-                if (!strcmp(migration_action, "commit")) {
-                    LOGDEBUG("[%s] notifying source %s to commit migration\n", migration_instance, migration_host);
-                    // Note: Really only need to specify the instance here.
-                    doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "commit");
-                } else if (!strcmp(migration_action, "rollback")) {
-                    LOGDEBUG("[%s] notifying node %s to roll back migration\n", migration_instance, migration_host);
-                    doMigrateInstances(pMeta, migration_host, migration_instance, NULL, 0, 0, "rollback");
+            for (int a = 0; a < numActions; a++) {
+                if (!strcmp(actions[a].action, "commit")) {
+                    // commits are held back while the source or this destination is already busy with enough migrations
+                    if (reserve_migration_commit(actions[a].instance, actions[a].node, resourceCacheStage->resources[i].hostname)) {
+                        LOGDEBUG("[%s] notifying source %s to commit migration\n", actions[a].instance, actions[a].node);
+                        // Note: Really only need to specify the instance here.
+                        if (doMigrateInstances(pMeta, actions[a].node, actions[a].instance, NULL, 0, 0, "commit")) {
+                            release_migration_commit(actions[a].instance);
+                        }
+                    }
+                } else if (!strcmp(actions[a].action, "rollback")) {
+                    LOGDEBUG("[%s] notifying node %s to roll back migration\n", actions[a].instance, actions[a].node);
+                    doMigrateInstances(pMeta, actions[a].node, actions[a].instance, NULL, 0, 0, "rollback");
                 } else {
-                    LOGWARN("unexpected migration action '%s' for node %s -- doing nothing\n", migration_action, migration_host);
+                    LOGWARN("unexpected migration action '%s' for node %s -- doing nothing\n", actions[a].action, actions[a].node);
                 }
-                EUCA_FREE(migration_host);
+                EUCA_FREE(actions[a].node);
+                EUCA_FREE(actions[a].instance);
+                EUCA_FREE(actions[a].action);
             }
-            EUCA_FREE(migration_instance);
-            EUCA_FREE(migration_action);
+            EUCA_FREE(actions);
 
             exit(0);
-        } else {
-            pids[i] = pid;
         }
     }
 
-    for (i = 0; i < resourceCacheStage->numResources; i++) {
-        rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
-        }
-    }
+    nc_fanout_end(&fan);
 
     invalidate_instanceCache();        // purge old instances from cache
+    print_migration_progress();
 
     // update canonical array of resources with latest changes
     // to resourceCacheStage (.idleStart may have changed) and
     // remove any unconfigured hosts if they have no instances
     refresh_resourceCache(resourceCacheStage, TRUE);
-    EUCA_FREE(pids);
 
+    EUCA_PROBE2(refresh__instances__done, resourceCacheStage->numResources, (long)(mono_time_sec() - op_start));
     LOGTRACE("done\n");
     return (0);
 }
@@ -3004,7 +4501,7 @@ int refresh_instances(ncMetadata * pMeta, int timeout, int dolock)
 int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 {
 
-    time_t op_start = time(NULL);
+    time_t op_start = mono_time_sec();
     LOGDEBUG("invoked: timeout=%d, dolock=%d\n", timeout, dolock);
 
     int history_size;
@@ -3012,32 +4509,47 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
     if ((sensor_get_config(&history_size, &collection_interval_time_ms) != 0) || history_size < 1 || collection_interval_time_ms == 0)
         return (1);                    // sensor system not configured yet
 
+    ncFanoutState fan = { 0 };
+
     // critical NC call section
     sem_mywait(RESCACHE);
     memcpy(resourceCacheStage, resourceCache, sizeof(ccResourceCache));
     sem_mypost(RESCACHE);
 
-    sem_close(locks[REFRESHLOCK]);
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-
-    int *pids = EUCA_ZALLOC(resourceCacheStage->numResources, sizeof(int));
-    if (!pids) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
+    nc_fanout_begin(&fan, resourceCacheStage->numResources, -1);
 
     for (int i = 0; i < resourceCacheStage->numResources; i++) {
-        sem_mywait(REFRESHLOCK);
-        pid_t pid = fork();
+        pid_t pid = nc_fanout_fork(&fan, i, FALSE);
         if (!pid) {
-            if (resourceCacheStage->resources[i].state == RESUP) {
+            // sensors are not worth probing a sick node for, the other refreshes do that
+            if ((resourceCacheStage->resources[i].state == RESUP) && (resourceCacheStage->resources[i].health.state == NCHEALTH_CLOSED)) {
                 int nctimeout = ncGetTimeout(op_start, timeout, 1, 1);
 
                 sensorResource **srs;
                 int srsLen;
+                char *cursors = NULL;
+                char **instIds = NULL;
+                int instIdsLen = 0;
+
+                // let the NC only send the values that the cache does not have of its instances
+                sem_mywait(INSTCACHE);
+                if ((instIds = EUCA_ZALLOC(MAXINSTANCES_PER_CC, sizeof(char *))) != NULL) {
+                    for (int j = instanceCacheGroupNext(INSTGRP_NODE, NULL, i, -1); j >= 0; j = instanceCacheGroupNext(INSTGRP_NODE, NULL, i, j)) {
+                        instIds[instIdsLen++] = strdup(instanceCache->summaries[j].instanceId);
+                    }
+                }
+                sem_mypost(INSTCACHE);
+                if (sensor_get_cursors(instIds, instIdsLen, &cursors) != EUCA_OK) {
+                    LOGWARN("failed to get sensor cursors for node %s, requesting all sensor data\n", resourceCacheStage->resources[i].hostname);
+                }
+                for (int j = 0; j < instIdsLen; j++) {
+                    EUCA_FREE(instIds[j]);
+                }
+                EUCA_FREE(instIds);
+
                 int rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
-                                      "ncDescribeSensors", history_size, collection_interval_time_ms,
-                                      NULL, 0, NULL, 0, &srs, &srsLen);
+                                      NC_OP_DESCRIBE_SENSORS_BATCHED, history_size, collection_interval_time_ms, cursors, &srs, &srsLen);
+                EUCA_FREE(cursors);
 
                 if (!rc) {
                     // update our cache
@@ -3047,72 +4559,91 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 
                     if (srsLen > 0) {
                         for (int j = 0; j < srsLen; j++) {
-                            EUCA_FREE(srs[j]);
+                            EUCA_SLAB_FREE(&sensor_resource_slab, srs[j]);
                         }
                         EUCA_FREE(srs);
                     }
                 }
             }
-            sem_mypost(REFRESHLOCK);
             exit(0);
-        } else {
-            pids[i] = pid;
         }
     }
 
-    for (int i = 0; i < resourceCacheStage->numResources; i++) {
-        int status;
-
-        int rc = timewait(pids[i], &status, 120);
-        if (!rc) {
-            // timed out, really bad failure (reset REFRESHLOCK semaphore)
-            sem_close(locks[REFRESHLOCK]);
-            locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
-            rc = 1;
-        } else if (rc > 0) {
-            // process exited, and wait picked it up.
-            if (WIFEXITED(status)) {
-                rc = WEXITSTATUS(status);
-            } else {
-                rc = 1;
-            }
-        } else {
-            // process no longer exists, and someone else reaped it
-            rc = 0;
-        }
-        if (rc) {
-            LOGWARN("error waiting for child pid '%d', exit code '%d'\n", pids[i], rc);
-        }
-    }
+    nc_fanout_end(&fan);
 
-    EUCA_FREE(pids);
     LOGTRACE("done\n");
     return (0);
 }
 
 //!
+//! qsort() comparator putting instance cache slots in ascending order
 //!
+//! @param[in] a pointer to the first slot
+//! @param[in] b pointer to the second slot
 //!
-//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
-//! @param[in]  instIds
-//! @param[in]  instIdsLen
-//! @param[out] outInsts
-//! @param[out] outInstsLen
+//! @return negative, zero or positive as the first slot comes before, with or after the second
+//!
+static int instanceCacheSlotCmp(const void *a, const void *b)
+{
+    return (*((const int *)a) - *((const int *)b));
+}
+
+//!
+//! Tells whether a cached instance passes the state and owner filters of a query. The
+//! caller holds INSTCACHE.
+//!
+//! @param[in] slot the instance cache slot
+//! @param[in] query the DescribeInstances query
+//!
+//! @return TRUE if the instance matches or FALSE otherwise
+//!
+static boolean instanceCacheQueryMatch(int slot, ccInstanceQuery * query)
+{
+    int i = 0;
+
+    if (query->statesLen > 0) {
+        for (i = 0; (i < query->statesLen) && strcmp(SP(query->states[i]), instanceCache->summaries[slot].state); i++) ;
+        if (i == query->statesLen)
+            return (FALSE);
+    }
+
+    if (query->ownerIdsLen > 0) {
+        for (i = 0; (i < query->ownerIdsLen) && strcmp(SP(query->ownerIds[i]), instanceCache->instances[slot].ownerId); i++) ;
+        if (i == query->ownerIdsLen)
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+//!
+//!
+//!
+//! @param[in]     pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]     instIds
+//! @param[in]     instIdsLen
+//! @param[in,out] query optional filters, projection and page of the request, NULL for all instances
+//! @param[out]    outInsts
+//! @param[out]    outInstsLen
 //!
 //! @return
 //!
 //! @pre
 //!
-//! @note
+//! @note With a query, the instances are walked in cache slot order starting at query->cursor
+//!       and at most query->maxResults of them are returned in full, query->nextCursor telling
+//!       where the next page starts. Matching instances that did not change since
+//!       query->changedSince are only listed in query->unchangedIds, which the caller frees.
 //!
-int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstance ** outInsts, int *outInstsLen)
+int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstanceQuery * query, ccInstance ** outInsts, int *outInstsLen)
 {
-    int i, rc, count;
+    int i, j, n, rc, count, start;
+    int ownerSlotsLen = 0;
+    int *ownerSlots = NULL;
     time_t op_start;
 
     LOGDEBUG("invoked: userId=%s, instIdsLen=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen);
 
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -3122,8 +4653,16 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
     *outInsts = NULL;
     *outInstsLen = 0;
 
+    if (query) {
+        query->timestamp = time(NULL);
+        query->nextCursor = -1;
+        query->unchangedIds = NULL;
+        query->unchangedIdsLen = 0;
+    }
+
     sem_mywait(INSTCACHE);
     count = 0;
+    start = 0;
     if (instanceCache->numInsts) {
         *outInsts = EUCA_ZALLOC(instanceCache->numInsts, sizeof(ccInstance));
         if (!*outInsts) {
@@ -3131,8 +4670,60 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
             unlock_exit(1);
         }
 
-        for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
+        if (query) {
+            if (query->changedSince && ((query->unchangedIds = EUCA_ZALLOC(instanceCache->numInsts, sizeof(char *))) == NULL)) {
+                LOGFATAL("out of memory!\n");
+                unlock_exit(1);
+            }
+            if ((query->cursor > 0) && (query->cursor < MAXINSTANCES_PER_CC))
+                start = query->cursor;
+        }
+
+        if (query && (query->ownerIdsLen > 0)) {
+            // only the instances of these owners, taken from the owner index and put back in slot order for paging
+            if ((ownerSlots = EUCA_ZALLOC(MAXINSTANCES_PER_CC, sizeof(int))) == NULL) {
+                LOGFATAL("out of memory!\n");
+                unlock_exit(1);
+            }
+            for (j = 0; j < query->ownerIdsLen; j++) {
+                for (i = instanceCacheGroupNext(INSTGRP_OWNER, query->ownerIds[j], 0, -1); (i >= 0) && (ownerSlotsLen < MAXINSTANCES_PER_CC);
+                     i = instanceCacheGroupNext(INSTGRP_OWNER, query->ownerIds[j], 0, i)) {
+                    if (i >= start)
+                        ownerSlots[ownerSlotsLen++] = i;
+                }
+            }
+            qsort(ownerSlots, ownerSlotsLen, sizeof(int), instanceCacheSlotCmp);
+        }
+
+        for (n = 0; ; n++) {
+            if (ownerSlots) {
+                // the same owner listed twice yields its slots twice
+                while ((n > 0) && (n < ownerSlotsLen) && (ownerSlots[n] == ownerSlots[n - 1]))
+                    n++;
+                if (n >= ownerSlotsLen)
+                    break;
+                i = ownerSlots[n];
+            } else if ((i = (start + n)) >= MAXINSTANCES_PER_CC) {
+                break;
+            }
+
             if (instanceCache->cacheState[i] == INSTVALID) {
+                if (query) {
+                    if (!instanceCacheQueryMatch(i, query))
+                        continue;
+
+                    if ((query->maxResults > 0) && (count >= query->maxResults)) {
+                        query->nextCursor = i;
+                        break;
+                    }
+
+                    if (query->changedSince && (instanceCache->lastchanged[i] < query->changedSince)) {
+                        if (query->unchangedIdsLen < instanceCache->numInsts)
+                            query->unchangedIds[query->unchangedIdsLen++] = strdup(instanceCache->summaries[i].instanceId);
+                        continue;
+                    }
+                }
+
                 if (count >= instanceCache->numInsts) {
                     LOGWARN("found more instances than reported by numInsts, will only report a subset of instances\n");
                     count = 0;
@@ -3144,11 +4735,15 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
                 } else if ((*outInsts)[count].migration_state == MIGRATION_CLEANING) {
                     (*outInsts)[count].migration_state = MIGRATION_IN_PROGRESS;
                 }
+                if (query && query->excludeUserData) {
+                    (*outInsts)[count].userData[0] = '\0';
+                }
                 count++;
             }
         }
 
-        *outInstsLen = instanceCache->numInsts;
+        *outInstsLen = (query ? count : instanceCache->numInsts);
+        EUCA_FREE(ownerSlots);
     }
     sem_mypost(INSTCACHE);
 
@@ -3158,6 +4753,10 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccIn
                  (*outInsts)[i].state, migration_state_names[(*outInsts)[i].migration_state], (*outInsts)[i].ccnet.publicIp, (*outInsts)[i].ccnet.privateIp);
     }
 
+    if (query) {
+        LOGDEBUG("query: returned=%d unchanged=%d nextCursor=%d\n", (*outInstsLen), query->unchangedIdsLen, query->nextCursor);
+    }
+
     LOGTRACE("done\n");
 
     shawn();
@@ -3260,12 +4859,12 @@ int powerDown(ncMetadata * pMeta, ccResource * node)
         return (0);
     }
 
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     LOGINFO("powerdown to %s\n", node->hostname);
 
     timeout = ncGetTimeout(op_start, OP_TIMEOUT, 1, 1);
-    rc = ncClientCall(pMeta, timeout, node->lockidx, node->ncURL, "ncPowerDown");
+    rc = ncClientCall(pMeta, timeout, node->lockidx, node->ncURL, NC_OP_POWER_DOWN);
 
     if (rc == 0) {
         changeState(node, RESASLEEP);
@@ -3406,6 +5005,32 @@ int ccInstance_to_ncInstance(ncInstance * dst, ccInstance * src)
     return (0);
 }
 
+//!
+//! Fills the hot-only view of an instance from a full CC instance record
+//!
+//! @param[in] dst a pointer to the instance summary to fill
+//! @param[in] src a pointer to the CC instance
+//!
+//! @return 0 on success or 1 on failure
+//!
+int ccInstance_to_ccInstanceSummary(ccInstanceSummary * dst, ccInstance * src)
+{
+    if (!dst || !src)
+        return (1);
+
+    euca_strncpy(dst->instanceId, src->instanceId, sizeof(dst->instanceId));
+    euca_strncpy(dst->state, src->state, sizeof(dst->state));
+    dst->ts = src->ts;
+    dst->ncHostIdx = src->ncHostIdx;
+    dst->migration_state = src->migration_state;
+    dst->vlan = src->ccnet.vlan;
+    dst->networkIndex = src->ccnet.networkIndex;
+    euca_strncpy(dst->privateMac, src->ccnet.privateMac, sizeof(dst->privateMac));
+    euca_strncpy(dst->publicIp, src->ccnet.publicIp, sizeof(dst->publicIp));
+    euca_strncpy(dst->privateIp, src->ccnet.privateIp, sizeof(dst->privateIp));
+    return (0);
+}
+
 //!
 //!
 //!
@@ -3435,10 +5060,10 @@ int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ra
         ret = schedule_instance_greedy(vm, outresid);
     } else if (config->schedPolicy == SCHEDROUNDROBIN) {
         ret = schedule_instance_roundrobin(vm, outresid);
-    } else if (config->schedPolicy == SCHEDPOWERSAVE) {
-        ret = schedule_instance_greedy(vm, outresid);
     } else if (config->schedPolicy == SCHEDUSER) {
         ret = schedule_instance_user(vm, amiId, kernelId, ramdiskId, instId, userData, platform, outresid);
+    } else if (sched_get_scorer(config->schedPolicy) != NULL) {
+        ret = schedule_instance_scored(vm, outresid);
     } else {
         ret = schedule_instance_greedy(vm, outresid);
     }
@@ -3933,14 +5558,16 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                    char *platform, int expiryTime, char *targetNode, char *rootDirective, ccInstance ** outInsts, int *outInstsLen)
 {
     int rc = 0, i = 0, done = 0, runCount = 0, resid = 0, foundnet = 0, error = 0, nidx = 0, thenidx = 0, pid = 0;
+    int nplanned = 0, nextplan = 0, nplaced = 0, round = 0, maxGroup = 0, numResources = 0, span = -1, *planResids = NULL, *groupSize = NULL;
+    time_t ncRunTimeout = 0;
     ccInstance *myInstance = NULL, *retInsts = NULL;
-    char instId[16], uuid[48];
     ccResource *res = NULL;
+    ccRunSlot *slots = NULL, *slot = NULL;
+    ncFanoutState fan = { 0 };
     char mac[32], privip[32], pubip[32];
 
     ncInstance *outInst = NULL;
     virtualMachine ncvm;
-    netConfig ncnet;
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -3979,7 +5606,8 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                         LOGDEBUG("constructed cacheable URL: %s\n", newURL);
                         rc = image_cache(ccvm->virtualBootRecord[i].id, newURL);
                         if (!rc) {
-                            snprintf(ccvm->virtualBootRecord[i].resourceLocation, CHAR_BUFFER_SIZE, "http://%s:8776/%s", config->proxyIp, ccvm->virtualBootRecord[i].id);
+                            snprintf(ccvm->virtualBootRecord[i].resourceLocation, CHAR_BUFFER_SIZE, "http://%s:%d/%s", config->proxyIp, IMAGE_PROXY_PORT,
+                                     ccvm->virtualBootRecord[i].id);
                         } else {
                             LOGWARN("could not cache image %s/%s\n", ccvm->virtualBootRecord[i].id, newURL);
                         }
@@ -4031,18 +5659,28 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
 
     runCount = 0;
 
-    // get updated resource information
+    // one slot per instance, shared with the dispatching children which write back the answer of their NC
+    slots = mmap(NULL, maxCount * sizeof(ccRunSlot), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    groupSize = EUCA_ZALLOC(MAXNODES, sizeof(int));
+    if ((slots == MAP_FAILED) || !groupSize) {
+        LOGFATAL("out of memory!\n");
+        unlock_exit(1);
+    }
 
-    done = 0;
-    for (i = 0; i < maxCount && !done; i++) {
-        snprintf(instId, 16, "%s", instIds[i]);
+    for (i = 0; i < maxCount; i++) {
+        slot = &(slots[i]);
+        bzero(slot, sizeof(ccRunSlot));
+        slot->resid = -1;
+        slot->state = RUNSLOT_NONE;
+
+        snprintf(slot->instId, 16, "%s", instIds[i]);
         if (uuidsLen > i) {
-            snprintf(uuid, 48, "%s", uuids[i]);
+            snprintf(slot->uuid, 48, "%s", uuids[i]);
         } else {
-            snprintf(uuid, 48, "UNSET");
+            snprintf(slot->uuid, 48, "UNSET");
         }
 
-        LOGDEBUG("running instance %s\n", instId);
+        LOGDEBUG("running instance %s\n", slot->instId);
 
         foundnet = 0;
 
@@ -4066,16 +5704,16 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
             foundnet = 1;
             thenidx = -1;
             snprintf(mac, 32, "%s", macAddrs[i]);
-            LOGDEBUG("setting instance '%s' macAddr to CLC input value '%s'\n", instId, mac);
+            LOGDEBUG("setting instance '%s' macAddr to CLC input value '%s'\n", slot->instId, mac);
         } else {
             // old modes - need to generate some values instead of reading them all from input
             sem_mywait(VNET);
             {
                 if (nidx == -1) {
-                    rc = vnetGenerateNetworkParams(vnetconfig, instId, vlan, -1, mac, pubip, privip);
+                    rc = vnetGenerateNetworkParams(vnetconfig, slot->instId, vlan, -1, mac, pubip, privip);
                     thenidx = -1;
                 } else {
-                    rc = vnetGenerateNetworkParams(vnetconfig, instId, vlan, networkIndexList[nidx], mac, pubip, privip);
+                    rc = vnetGenerateNetworkParams(vnetconfig, slot->instId, vlan, networkIndexList[nidx], mac, pubip, privip);
                     thenidx = nidx;
                     nidx++;
                 }
@@ -4096,60 +5734,137 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
 
         if (mac[0] == '\0' || !foundnet) {
             LOGERROR("could not find/initialize any free network address, failing doRunInstances()\n");
+            continue;
+        }
+
+        slot->ncnet.vlan = vlan;
+        if (thenidx >= 0) {
+            slot->ncnet.networkIndex = networkIndexList[thenidx];
         } else {
-            // "run" the instance
-            memcpy(&ncvm, ccvm, sizeof(virtualMachine));
+            slot->ncnet.networkIndex = -1;
+        }
+        snprintf(slot->mac, 32, "%s", mac);
+        snprintf(slot->ncnet.privateMac, MAC_BUFFER_SIZE, "%s", mac);
+        snprintf(slot->ncnet.privateIp, IP_BUFFER_SIZE, "%s", privip);
+        snprintf(slot->ncnet.publicIp, IP_BUFFER_SIZE, "%s", pubip);
+        slot->state = RUNSLOT_PENDING;
+    }
 
-            ncnet.vlan = vlan;
-            if (thenidx >= 0) {
-                ncnet.networkIndex = networkIndexList[thenidx];
-            } else {
-                ncnet.networkIndex = -1;
-            }
-            snprintf(ncnet.privateMac, MAC_BUFFER_SIZE, "%s", mac);
-            snprintf(ncnet.privateIp, IP_BUFFER_SIZE, "%s", privip);
-            snprintf(ncnet.publicIp, IP_BUFFER_SIZE, "%s", pubip);
+    // place the whole reservation in one pass when the policy is served by the capacity index
+    if (targetNode == NULL) {
+        planResids = EUCA_ZALLOC(maxCount, sizeof(int));
+        if (!planResids) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
+        }
 
-            sem_mywait(RESCACHE);
+        span = trace_begin("schedule.plan");
+        sem_mywait(RESCACHE);
+        sem_mywait(CONFIG);
+        nplanned = schedule_instance_batch(ccvm, maxCount, planResids);
+        sem_mypost(CONFIG);
+        sem_mypost(RESCACHE);
+        trace_end(span, FALSE);
+    }
 
-            resid = 0;
+    // Each round places the pending instances, reserving their capacity right away so that concurrent requests
+    // cannot oversubscribe a node while it is being dispatched to, then runs every node's group concurrently.
+    // Instances whose node failed go back to pending and are placed elsewhere, the failed node is marked down.
+    nextplan = 0;
+    for (round = 0; round <= MAXNODES; round++) {
+        nplaced = maxGroup = 0;
+        bzero(groupSize, MAXNODES * sizeof(int));
 
-            sem_mywait(CONFIG);
-            rc = schedule_instance(ccvm, amiId, kernelId, ramdiskId, instId, userData, platform, targetNode, &resid);
-            sem_mypost(CONFIG);
+        span = trace_begin("schedule");
+        sem_mywait(RESCACHE);
+        sem_mywait(CONFIG);
+        numResources = resourceCache->numResources;
+        for (i = 0; i < maxCount; i++) {
+            slot = &(slots[i]);
+            if (slot->state != RUNSLOT_PENDING)
+                continue;
+
+            resid = 0;
+            if ((nextplan < nplanned) && !schedule_instance_planned(ccvm, planResids[nextplan])) {
+                // planned placement still holds
+                resid = planResids[nextplan];
+                rc = 0;
+            } else {
+                // no plan, or the resource changed (or failed) since the plan was made
+                rc = schedule_instance(ccvm, amiId, kernelId, ramdiskId, slot->instId, userData, platform, targetNode, &resid);
+            }
+            nextplan++;
 
-            res = &(resourceCache->resources[resid]);
             if (rc) {
                 // could not find resource
                 LOGERROR("scheduler could not find resource to run the instance on\n");
                 // couldn't run this VM, remove networking information from system
-                free_instanceNetwork(mac, vlan, 1, 1);
-            } else {
-                int ret;
+                free_instanceNetwork(slot->mac, vlan, 1, 1);
+                slot->state = RUNSLOT_NONE;
+                continue;
+            }
+
+            res = &(resourceCache->resources[resid]);
+            res->availMemory -= ccvm->mem;
+            res->availDisk -= ccvm->disk;
+            res->availCores -= ccvm->cores;
+            count_resourceCacheNode(resid);
+            LOGINFO("scheduler decided to run instance %s on resource %s\n", slot->instId, res->ncURL);
+
+            slot->resid = resid;
+            slot->rc = 1;
+            slot->state = RUNSLOT_PLACED;
+            groupSize[resid]++;
+            maxGroup = MAX(maxGroup, groupSize[resid]);
+            nplaced++;
+        }
+        sem_mypost(CONFIG);
+        sem_mypost(RESCACHE);
+        trace_end(span, (nplaced == 0));
 
-                // try to run the instance on the chosen resource
-                LOGINFO("scheduler decided to run instance %s on resource %s, running count %d\n", instId, res->ncURL, res->running);
+        if (!nplaced)
+            break;
 
-                outInst = NULL;
+        // a node the scheduler just powered up gets until the wake threshold to take its instances
+        if (config->schedPolicy == SCHEDPOWERSAVE) {
+            ncRunTimeout = config->wakeThresh;
+        } else {
+            ncRunTimeout = 15;
+        }
 
-                pid = fork();
-                if (pid == 0) {
-                    time_t startRun, ncRunTimeout;
+        // one child per node sends that node's instances back to back, all nodes in parallel, with a
+        // deadline past the last call that each instance's retries may start (and their 1 second pauses)
+        nc_fanout_begin(&fan, numResources, -1);
+        fan.timeout = ((ncRunTimeout + OP_TIMEOUT_PERNODE + 1) * maxGroup) + NC_FANOUT_TERM_GRACE;
+        for (resid = 0; resid < numResources; resid++) {
+            if (!groupSize[resid])
+                continue;
 
-                    ret = 0;
+            res = &(resourceCache->resources[resid]);
+            LOGDEBUG("dispatching %d instance(s) to resource %s\n", groupSize[resid], res->ncURL);
+            if ((pid = nc_fanout_fork(&fan, resid, FALSE)) < 0) {
+                // nothing was sent, release these instances rather than blaming the node
+                for (i = 0; i < maxCount; i++) {
+                    if ((slots[i].state == RUNSLOT_PLACED) && (slots[i].resid == resid))
+                        slots[i].rc = -1;
+                }
+            } else if (pid == 0) {
+                for (i = 0; i < maxCount; i++) {
+                    slot = &(slots[i]);
+                    if ((slot->state != RUNSLOT_PLACED) || (slot->resid != resid))
+                        continue;
+
+                    time_t startRun;
+
+                    outInst = NULL;
+                    memcpy(&ncvm, ccvm, sizeof(virtualMachine));
                     LOGTRACE("sending run instance: node=%s instanceId=%s emiId=%s mac=%s privIp=%s pubIp=%s vlan=%d networkIdx=%d key=%.32s... "
-                             "mem=%d disk=%d cores=%d\n", res->ncURL, instId, SP(amiId), ncnet.privateMac, ncnet.privateIp, ncnet.publicIp,
-                             ncnet.vlan, ncnet.networkIndex, SP(keyName), ncvm.mem, ncvm.disk, ncvm.cores);
+                             "mem=%d disk=%d cores=%d\n", res->ncURL, slot->instId, SP(amiId), slot->ncnet.privateMac, slot->ncnet.privateIp, slot->ncnet.publicIp,
+                             slot->ncnet.vlan, slot->ncnet.networkIndex, SP(keyName), ncvm.mem, ncvm.disk, ncvm.cores);
 
                     rc = 1;
-                    startRun = time(NULL);
-                    if (config->schedPolicy == SCHEDPOWERSAVE) {
-                        ncRunTimeout = config->wakeThresh;
-                    } else {
-                        ncRunTimeout = 15;
-                    }
-
-                    while (rc && ((time(NULL) - startRun) < ncRunTimeout)) {
+                    startRun = mono_time_sec();
+                    while (rc && ((mono_time_sec() - startRun) < ncRunTimeout)) {
 
                         boolean is_windows = (strstr(platform, "windows") != NULL) ? TRUE : FALSE;
                         boolean has_creds = (credential != NULL && strlen(credential) > 0) ? TRUE : FALSE;
@@ -4168,7 +5883,7 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                                     LOGWARN("mkdir failed: could not make directory '%s', check permissions\n", cdir);
                                 }
                             }
-                            snprintf(cdir, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/windows/%s/", config->eucahome, instId);
+                            snprintf(cdir, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/windows/%s/", config->eucahome, slot->instId);
                             if (check_directory(cdir)) {
                                 if (mkdir(cdir, 0700)) {
                                     LOGWARN("mkdir failed: could not make directory '%s', check permissions\n", cdir);
@@ -4179,7 +5894,7 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                             } else {
                                 if (is_windows) {
                                     // drop encrypted windows password and floppy on filesystem
-                                    rc = makeWindowsFloppy(config->eucahome, cdir, keyName, instId);
+                                    rc = makeWindowsFloppy(config->eucahome, cdir, keyName, slot->instId);
                                 } else if (has_creds) {
                                     // decode the credential and place it into floppy on filesystem
                                     rc = make_credential_floppy(config->eucahome, cdir, credential);
@@ -4189,96 +5904,92 @@ int doRunInstances(ncMetadata * pMeta, char *amiId, char *kernelId, char *ramdis
                                 }
                             }
                         }
-                        rc = ncClientCall(pMeta, OP_TIMEOUT_PERNODE, res->lockidx, res->ncURL, "ncRunInstance", uuid, instId, reservationId, &ncvm,
-                                          amiId, amiURL, kernelId, kernelURL, ramdiskId, ramdiskURL, ownerId, accountId, keyName, &ncnet, userData, credential,
+                        rc = ncClientCall(pMeta, OP_TIMEOUT_PERNODE, res->lockidx, res->ncURL, NC_OP_RUN_INSTANCE, slot->uuid, slot->instId, reservationId, &ncvm,
+                                          amiId, amiURL, kernelId, kernelURL, ramdiskId, ramdiskURL, ownerId, accountId, keyName, &(slot->ncnet), userData, credential,
                                           launchIndex, platform, expiryTime, netNames, netNamesLen, rootDirective, &outInst);
-                        LOGDEBUG("sent run request for instance '%s' on resource '%s': result '%s' uuis '%s'\n", instId, res->ncURL, uuid, rc ? "FAIL" : "SUCCESS");
+                        LOGDEBUG("sent run request for instance '%s' on resource '%s': result '%s' uuis '%s'\n", slot->instId, res->ncURL, slot->uuid, rc ? "FAIL" : "SUCCESS");
                         if (rc) {
                             // make sure we get the latest topology information before trying again
                             sem_mywait(CONFIG);
                             memcpy(pMeta->services, config->services, sizeof(serviceInfoType) * 16);
-                            memcpy(pMeta->disabledServices, config->disabledServices, sizeof(serviceInfoType) * 16);
-                            memcpy(pMeta->notreadyServices, config->notreadyServices, sizeof(serviceInfoType) * 16);
-                            sem_mypost(CONFIG);
-                            sleep(1);
-                        }
-                    }
-                    if (!rc) {
-                        ret = 0;
-                    } else {
-                        ret = 1;
-                    }
-
-                    exit(ret);
-                } else {
-                    rc = 0;
-                    {
-                        int status;
-
-                        if (res->running > 0) {
-                            res->running++;
-                        }
-                        pid_t p = timewait(pid, &status, OP_TIMEOUT - 5);
-                        if (res->running > 0) {
-                            res->running--;
-                        }
-
-                        if (p > 0) {
-                            if (WIFEXITED(status)) {
-                                rc = WEXITSTATUS(status);
-                            } else {
-                                rc = 1; // child crashed
-                            }
-                        } else {
-                            rc = 1;    // timeout or error
+                            memcpy(pMeta->disabledServices, config->disabledServices, sizeof(serviceInfoType) * 16);
+                            memcpy(pMeta->notreadyServices, config->notreadyServices, sizeof(serviceInfoType) * 16);
+                            sem_mypost(CONFIG);
+                            sleep(1);
                         }
                     }
-                    LOGDEBUG("call complete (pid/rc): %d/%d\n", pid, rc);
+
+                    // the parent reads this back from the shared slot
+                    slot->rc = ((rc) ? 1 : 0);
                 }
-                if (rc != 0) {
+                exit(0);
+            }
+        }
+        nc_fanout_end(&fan);
+
+        // collect the results: keep what started, roll back what did not
+        sem_mywait(RESCACHE);
+        for (i = 0; i < maxCount; i++) {
+            slot = &(slots[i]);
+            if (slot->state != RUNSLOT_PLACED)
+                continue;
+
+            resid = slot->resid;
+            res = &(resourceCache->resources[resid]);
+            if (slot->rc != 0) {
+                res->availMemory += ccvm->mem;
+                res->availDisk += ccvm->disk;
+                res->availCores += ccvm->cores;
+                count_resourceCacheNode(resid);
+                slot->resid = -1;
+
+                if (slot->rc > 0) {
                     // problem
                     LOGERROR("tried to run the VM, but runInstance() failed; marking resource '%s' as down\n", res->ncURL);
                     res->state = RESDOWN;
-                    i--;
-                    // couldn't run this VM, remove networking information from system
-                    free_instanceNetwork(mac, vlan, 1, 1);
+                    slot->state = RUNSLOT_PENDING;
                 } else {
-                    res->availMemory -= ccvm->mem;
-                    res->availDisk -= ccvm->disk;
-                    res->availCores -= ccvm->cores;
-
-                    LOGDEBUG("resource information after schedule/run: %d/%d, %d/%d, %d/%d\n", res->availMemory, res->maxMemory,
-                             res->availCores, res->maxCores, res->availDisk, res->maxDisk);
-
-                    myInstance = &(retInsts[runCount]);
-                    bzero(myInstance, sizeof(ccInstance));
+                    // couldn't run this VM, remove networking information from system
+                    LOGERROR("could not dispatch instance %s to resource '%s'\n", slot->instId, res->ncURL);
+                    free_instanceNetwork(slot->mac, vlan, 1, 1);
+                    slot->state = RUNSLOT_NONE;
+                }
+                continue;
+            }
 
-                    allocate_ccInstance(myInstance, instId, amiId, kernelId, ramdiskId, amiURL, kernelURL, ramdiskURL, ownerId, accountId, "Pending",
-                                        "", time(NULL), reservationId, &ncnet, &ncnet, ccvm, resid, keyName, resourceCache->resources[resid].ncURL,
-                                        userData, launchIndex, platform, myInstance->guestStateName, myInstance->bundleTaskStateName, myInstance->groupNames, myInstance->volumes,
-                                        myInstance->volumesSize, myInstance->bundleTaskProgress);
+            LOGDEBUG("resource information after schedule/run: %d/%d, %d/%d, %d/%d\n", res->availMemory, res->maxMemory,
+                     res->availCores, res->maxCores, res->availDisk, res->maxDisk);
+            nc_poll_hurry(res);
 
-                    sensor_add_resource(myInstance->instanceId, "instance", uuid);
-                    sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
+            myInstance = &(retInsts[runCount]);
+            bzero(myInstance, sizeof(ccInstance));
 
-                    // start up DHCP
-                    sem_mywait(CONFIG);
-                    config->kick_dhcp = 1;
-                    sem_mypost(CONFIG);
+            allocate_ccInstance(myInstance, slot->instId, amiId, kernelId, ramdiskId, amiURL, kernelURL, ramdiskURL, ownerId, accountId, "Pending",
+                                "", time(NULL), reservationId, &(slot->ncnet), &(slot->ncnet), ccvm, resid, keyName, resourceCache->resources[resid].ncURL,
+                                userData, launchIndex, platform, myInstance->guestStateName, myInstance->bundleTaskStateName, myInstance->groupNames, myInstance->volumes,
+                                myInstance->volumesSize, myInstance->bundleTaskProgress);
 
-                    // add the instance to the cache, and continue on
-                    refresh_instanceCache(myInstance->instanceId, myInstance);
-                    print_ccInstance("", myInstance);
+            sensor_add_resource(myInstance->instanceId, "instance", slot->uuid);
+            sensor_set_resource_alias(myInstance->instanceId, myInstance->ncnet.privateIp);
 
-                    runCount++;
-                }
-            }
+            // start up DHCP
+            sem_mywait(CONFIG);
+            config->kick_dhcp = 1;
+            sem_mypost(CONFIG);
 
-            sem_mypost(RESCACHE);
+            // add the instance to the cache, and continue on
+            refresh_instanceCache(myInstance->instanceId, myInstance);
+            print_ccInstance("", myInstance);
 
+            slot->state = RUNSLOT_RUNNING;
+            runCount++;
         }
-
+        sem_mypost(RESCACHE);
     }
+
+    EUCA_FREE(planResids);
+    EUCA_FREE(groupSize);
+    munmap(slots, maxCount * sizeof(ccRunSlot));
     *outInstsLen = runCount;
     *outInsts = retInsts;
 
@@ -4318,13 +6029,13 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
     int done = 0;
     int ret = EUCA_OK;
     int timeout = 0;
-    char *rawconsole = NULL;
     char pwfile[EUCA_MAX_PATH] = "";
     time_t op_start = 0;
+    file_view rawconsole = { 0 };
     ccInstance *myInstance = NULL;
-    ccResourceCache resourceCacheLocal = { {{{0}}} };
+    ccResource resourceLocal = { {0} };
 
-    op_start = time(NULL);
+    op_start = mono_time_sec();
     *consoleOutput = NULL;
 
     rc = initialize(pMeta, FALSE);
@@ -4335,12 +6046,6 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
     LOGINFO("[%s] requesting console output\n", SP(instanceId));
     LOGDEBUG("invoked: instId=%s\n", SP(instanceId));
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
-
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
         start = myInstance->ncHostIdx;
@@ -4348,27 +6053,28 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
         EUCA_FREE(myInstance);
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     for (i = start, done = 0; ((i < stop) && !done); i++) {
+        if (get_resourceCacheEntry(i, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         EUCA_FREE(*consoleOutput);
 
         // if not talking to Eucalyptus NC (but, e.g., a Broker)
-        if (!strstr(resourceCacheLocal.resources[i].ncURL, "EucalyptusNC")) {
+        if (!strstr(resourceLocal.ncURL, "EucalyptusNC")) {
             *consoleOutput = NULL;
             snprintf(pwfile, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/windows/%s/console.append.log", config->eucahome, instanceId);
 
-            rawconsole = NULL;
             if (!check_file(pwfile)) { // the console log file should exist for a Windows guest (with encrypted password in it)
-                rawconsole = file2str(pwfile);
+                if (file_view_open(pwfile, -1, &rawconsole) == EUCA_OK) {
+                    *consoleOutput = base64_enc(((u8 *) rawconsole.data), rawconsole.len);
+                    file_view_close(&rawconsole);
+                }
             } else {                   // the console log file will not exist for a Linux guest
-                rawconsole = strdup("not implemented");
-            }
-
-            if (rawconsole) {
-                *consoleOutput = base64_enc(((u8 *) rawconsole), strlen(rawconsole));
-                EUCA_FREE(rawconsole);
+                *consoleOutput = base64_enc(((u8 *) "not implemented"), strlen("not implemented"));
             }
             // set the return code accordingly
             if (*consoleOutput == NULL) {
@@ -4379,7 +6085,7 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
             done++;                    // quit on the first host, since they are not queried remotely
         } else {                       // otherwise, we *are* talking to a Eucalyptus NC, so make the remote call
             timeout = ncGetTimeout(op_start, OP_TIMEOUT, (stop - start), i);
-            rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[i].lockidx, resourceCacheLocal.resources[i].ncURL, "ncGetConsoleOutput", instanceId, consoleOutput);
+            rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_GET_CONSOLE_OUTPUT, instanceId, consoleOutput);
         }
 
         if (rc) {
@@ -4410,16 +6116,19 @@ int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutpu
 //!
 int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
 {
-    int i, j, rc, numInsts, start, stop, done, timeout = 0, ret = 0;
+    int i, j, rc, start, stop, done, timeout = 0, ret = 0;
+    int numHosts = 0, batchLen = 0, idx = 0;
+    int *hostIdx = NULL;
     char *instId;
+    char **batch = NULL;
     ccInstance *myInstance;
     time_t op_start;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
-    i = j = numInsts = 0;
+    i = j = 0;
     instId = NULL;
     myInstance = NULL;
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -4429,27 +6138,69 @@ int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
     LOGINFO("rebooting %d instances\n", instIdsLen);
     LOGDEBUG("invoked: instIdsLen=%d\n", instIdsLen);
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    if (instIdsLen > 0) {
+        hostIdx = EUCA_ZALLOC(instIdsLen, sizeof(int));
+        batch = EUCA_ZALLOC(instIdsLen, sizeof(char *));
+        if (!hostIdx || !batch) {
+            LOGFATAL("out of memory!\n");
+            EUCA_FREE(hostIdx);
+            EUCA_FREE(batch);
+            return (1);
+        }
+    }
 
     for (i = 0; i < instIdsLen; i++) {
-        instId = instIds[i];
-        rc = find_instanceCacheId(instId, &myInstance);
-        if (!rc) {
-            // found the instance in the cache
-            start = myInstance->ncHostIdx;
-            stop = start + 1;
-            EUCA_FREE(myInstance);
+        if (find_instanceCacheId(instIds[i], &myInstance) == EUCA_OK && myInstance) {
+            // found the instance in the cache, reboot it along with the rest on its node
+            hostIdx[i] = myInstance->ncHostIdx;
+            for (j = 0; j < i && hostIdx[j] != hostIdx[i]; j++) ;
+            if (j == i)
+                numHosts++;
         } else {
-            start = 0;
-            stop = resourceCacheLocal.numResources;
+            hostIdx[i] = -1;
+        }
+        EUCA_FREE(myInstance);
+    }
+
+    // one ncRebootInstances per node for the cached instances
+    for (i = 0; i < instIdsLen; i++) {
+        if (hostIdx[i] < 0)
+            continue;
+        for (j = 0; j < i && hostIdx[j] != hostIdx[i]; j++) ;
+        if (j < i)
+            continue;                  // this node was already handled
+
+        for (batchLen = 0, j = i; j < instIdsLen; j++) {
+            if (hostIdx[j] == hostIdx[i])
+                batch[batchLen++] = instIds[j];
+        }
+
+        if (get_resourceCacheEntry(hostIdx[i], &resourceLocal) == EUCA_OK) {
+            timeout = ncGetTimeout(op_start, OP_TIMEOUT, numHosts, idx);
+            if (ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_REBOOT_INSTANCES, batch, batchLen)) {
+                ret = 1;
+            }
         }
+        idx++;
+    }
+
+    // instances we know nothing about are looked for on every node
+    for (i = 0; i < instIdsLen; i++) {
+        if (hostIdx[i] >= 0)
+            continue;
+
+        instId = instIds[i];
+        start = 0;
+        stop = get_resourceCacheSize();
 
         done = 0;
         for (j = start; j < stop && !done; j++) {
+            if (get_resourceCacheEntry(j, &resourceLocal) != EUCA_OK) {
+                break;
+            }
+
             timeout = ncGetTimeout(op_start, OP_TIMEOUT, (stop - start), j);
-            rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[j].lockidx, resourceCacheLocal.resources[j].ncURL, "ncRebootInstance", instId);
+            rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_REBOOT_INSTANCE, instId);
             if (rc) {
                 ret = 1;
             } else {
@@ -4459,6 +6210,9 @@ int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
         }
     }
 
+    EUCA_FREE(hostIdx);
+    EUCA_FREE(batch);
+
     LOGTRACE("done\n");
 
     shawn();
@@ -4483,13 +6237,13 @@ int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen)
 //!
 int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int **outStatus)
 {
-    int i, j, shutdownState, previousState, rc, start, stop, done = 0, ret = 0;
-    char *instId;
+    int i, j, rc, batchLen = 0;
+    int *hostIdx = NULL;
+    char **batch = NULL;
     ccInstance *myInstance = NULL;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     i = j = 0;
-    instId = NULL;
     myInstance = NULL;
 
     rc = initialize(pMeta, FALSE);
@@ -4502,75 +6256,65 @@ int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int
     LOGINFO("terminating instances\n");
     LOGDEBUG("invoked: userId=%s, instIdsLen=%d, firstInstId=%s, force=%d\n", SP(pMeta ? pMeta->userId : "UNSET"), instIdsLen, SP(instIdsLen ? instIds[0] : "UNSET"), force);
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
+    if (instIdsLen > 0) {
+        hostIdx = EUCA_ZALLOC(instIdsLen, sizeof(int));
+        batch = EUCA_ZALLOC(instIdsLen, sizeof(char *));
+        if (!hostIdx || !batch) {
+            LOGFATAL("out of memory!\n");
+            EUCA_FREE(hostIdx);
+            EUCA_FREE(batch);
+            return (1);
+        }
+    }
 
     for (i = 0; i < instIdsLen; i++) {
-        instId = instIds[i];
-        rc = find_instanceCacheId(instId, &myInstance);
-        if (!rc) {
-            // found the instance in the cache
-            if (myInstance != NULL && (!strcmp(myInstance->state, "Pending") || !strcmp(myInstance->state, "Extant") || !strcmp(myInstance->state, "Unknown"))) {
-                start = myInstance->ncHostIdx;
-                stop = start + 1;
-            } else {
-                // instance is not in a terminatable state
-                start = 0;
-                stop = 0;
-                (*outStatus)[i] = 0;
+        (*outStatus)[i] = 0;
+        hostIdx[i] = -1;
+        if (find_instanceCacheId(instIds[i], &myInstance) == EUCA_OK && myInstance) {
+            // only instances in a terminatable state are sent to their node
+            if (!strcmp(myInstance->state, "Pending") || !strcmp(myInstance->state, "Extant") || !strcmp(myInstance->state, "Unknown")) {
+                hostIdx[i] = myInstance->ncHostIdx;
             }
-            EUCA_FREE(myInstance);
-        } else {
-            // instance is not in cache, try all resources
-
-            start = 0;
-            stop = 0;
-            (*outStatus)[i] = 0;
         }
+        EUCA_FREE(myInstance);
+    }
 
-        done = 0;
-        for (j = start; j < stop && !done; j++) {
-            if (resourceCacheLocal.resources[j].state == RESUP) {
-
-                if (!strstr(resourceCacheLocal.resources[j].ncURL, "EucalyptusNC")) {
-                    char cdir[EUCA_MAX_PATH];
-                    char cfile[EUCA_MAX_PATH];
-                    snprintf(cdir, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/windows/%s/", config->eucahome, instId);
-                    if (!check_directory(cdir)) {
-                        snprintf(cfile, EUCA_MAX_PATH, "%s/floppy", cdir);
-                        if (!check_file(cfile))
-                            unlink(cfile);
-                        snprintf(cfile, EUCA_MAX_PATH, "%s/console.append.log", cdir);
-                        if (!check_file(cfile))
-                            unlink(cfile);
-
-                        if (rmdir(cdir)) {
-                            LOGWARN("rmdir failed: unable to remove directory '%s', check permissions\n", cdir);
-                        }
-                    }
-                }
+    // one ncTerminateInstances per node, which also releases the addresses of the instances
+    for (i = 0; i < instIdsLen; i++) {
+        if (hostIdx[i] < 0)
+            continue;
+        for (j = 0; j < i && hostIdx[j] != hostIdx[i]; j++) ;
+        if (j < i)
+            continue;                  // this node was already handled
 
-                rc = ncClientCall(pMeta, 0, resourceCacheLocal.resources[j].lockidx, resourceCacheLocal.resources[j].ncURL, "ncTerminateInstance",
-                                  instId, force, &shutdownState, &previousState);
-                if (rc) {
-                    (*outStatus)[i] = 1;
-                    LOGWARN("failed to terminate '%s': instance may not exist any longer\n", instId);
-                    ret = 1;
-                } else {
-                    (*outStatus)[i] = 0;
-                    ret = 0;
-                    done++;
-                }
-                rc = ncClientCall(pMeta, 0, resourceCacheStage->resources[j].lockidx, resourceCacheStage->resources[j].ncURL, "ncAssignAddress", instId, "0.0.0.0");
-                if (rc) {
-                    // problem, but will retry next time
-                    LOGWARN("could not send AssignAddress to NC\n");
-                }
+        if ((get_resourceCacheEntry(hostIdx[i], &resourceLocal) != EUCA_OK) || (resourceLocal.state != RESUP))
+            continue;
+
+        for (batchLen = 0, j = i; j < instIdsLen; j++) {
+            if (hostIdx[j] == hostIdx[i]) {
+                batch[batchLen++] = instIds[j];
+                if (!strstr(resourceLocal.ncURL, "EucalyptusNC"))
+                    remove_windows_files(instIds[j]);
+            }
+        }
+
+        rc = ncClientCall(pMeta, 0, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_TERMINATE_INSTANCES, batch, batchLen, force);
+        sem_mywait(RESCACHE);
+        if ((hostIdx[i] < resourceCache->numResources) && !strcmp(resourceCache->resources[hostIdx[i]].hostname, resourceLocal.hostname))
+            nc_poll_hurry(&(resourceCache->resources[hostIdx[i]]));
+        sem_mypost(RESCACHE);
+        if (rc) {
+            LOGWARN("failed to terminate %d instance(s) on %s: instances may not exist any longer\n", batchLen, resourceLocal.hostname);
+            for (j = i; j < instIdsLen; j++) {
+                if (hostIdx[j] == hostIdx[i])
+                    (*outStatus)[j] = 1;
             }
         }
     }
 
+    EUCA_FREE(hostIdx);
+    EUCA_FREE(batch);
+
     LOGTRACE("done\n");
 
     shawn();
@@ -4578,6 +6322,31 @@ int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int
     return (0);
 }
 
+//!
+//! Removes the Windows floppy and console files the CC keeps for an instance on a non-Eucalyptus NC
+//!
+//! @param[in] instId the instance identifier string (i-XXXXXXXX)
+//!
+static void remove_windows_files(const char *instId)
+{
+    char cdir[EUCA_MAX_PATH] = "";
+    char cfile[EUCA_MAX_PATH] = "";
+
+    snprintf(cdir, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/windows/%s/", config->eucahome, instId);
+    if (!check_directory(cdir)) {
+        snprintf(cfile, EUCA_MAX_PATH, "%s/floppy", cdir);
+        if (!check_file(cfile))
+            unlink(cfile);
+        snprintf(cfile, EUCA_MAX_PATH, "%s/console.append.log", cdir);
+        if (!check_file(cfile))
+            unlink(cfile);
+
+        if (rmdir(cdir)) {
+            LOGWARN("rmdir failed: unable to remove directory '%s', check permissions\n", cdir);
+        }
+    }
+}
+
 //!
 //!
 //!
@@ -4597,11 +6366,11 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
     int i, rc, start = 0, stop = 0, ret = 0, done = 0, timeout;
     ccInstance *myInstance;
     time_t op_start;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     i = 0;
     myInstance = NULL;
-    op_start = time(NULL);
+    op_start = mono_time_sec();
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled()) {
@@ -4615,10 +6384,6 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
     rc = find_instanceCacheId(instanceId, &myInstance);
     if (!rc) {
         // found the instance in the cache
@@ -4629,13 +6394,17 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (i = start; i < stop && !done; i++) {
+        if (get_resourceCacheEntry(i, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, stop - start, i);
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[i].lockidx, resourceCacheLocal.resources[i].ncURL, "ncCreateImage", instanceId, volumeId, remoteDev);
+        rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_CREATE_IMAGE, instanceId, volumeId, remoteDev);
         if (rc) {
             ret = 1;
         } else {
@@ -4777,6 +6546,24 @@ int doDescribeSensors(ncMetadata * pMeta, int historySize, long long collectionI
     return (0);
 }
 
+//!
+//! Resource cache matching function selecting a node which is not asleep by hostname
+//!
+//! @param[in] res a pointer to the resource to check
+//! @param[in] hostname the hostname to look for
+//!
+//! @return 0 on match or 1 otherwise
+//!
+static int awakeHostnameCmp(ccResource * res, void *hostname)
+{
+    if (!res || !hostname)
+        return (1);
+
+    if ((res->state != RESASLEEP) && !strcmp(res->hostname, (char *)hostname))
+        return (0);
+    return (1);
+}
+
 //!
 //! Implements the CC logic of modifying state of a node controller
 //!
@@ -4793,8 +6580,7 @@ int doDescribeSensors(ncMetadata * pMeta, int historySize, long long collectionI
 int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
 {
     int i, rc, ret = 0, timeout;
-    int src_index = -1;
-    ccResourceCache resourceCacheLocal;
+    ccResource resourceLocal = { {0} };
 
     // no need to call initialize(pMeta, FALSE) because we call doModifyNode internally, from doEnable/DisableService
     if (ccIsEnabled()) {
@@ -4807,27 +6593,14 @@ int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
     }
     LOGINFO("modifying node %s with state=%s\n", SP(nodeName), SP(stateName));
 
-    sem_mywait(RESCACHE);
-    memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    sem_mypost(RESCACHE);
-
-    for (i = 0; i < resourceCacheLocal.numResources && (src_index == -1); i++) {
-        if (resourceCacheLocal.resources[i].state != RESASLEEP) {
-            if (!strcmp(resourceCacheLocal.resources[i].hostname, nodeName)) {
-                // found it
-                src_index = i;
-                break;
-            }
-        }
-    }
-    if (src_index == -1) {
+    if (find_resourceCacheEntry(awakeHostnameCmp, nodeName, &resourceLocal, NULL) != EUCA_OK) {
         LOGERROR("node requested for modification (%s) cannot be found\n", SP(nodeName));
         ret = 1;
         goto out;
     }
 
-    timeout = ncGetTimeout(time(NULL), OP_TIMEOUT, 1, 0);
-    rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[src_index].lockidx, resourceCacheLocal.resources[src_index].ncURL, "ncModifyNode", stateName);   // no need to pass nodeName as ncClientCall sets that up for all NC requests
+    timeout = ncGetTimeout(mono_time_sec(), OP_TIMEOUT, 1, 0);
+    rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_MODIFY_NODE, stateName);   // no need to pass nodeName as ncClientCall sets that up for all NC requests
     if (rc) {
         ret = 1;
         goto out;
@@ -4843,6 +6616,7 @@ int doModifyNode(ncMetadata * pMeta, char *nodeName, char *stateName)
                     res->ncState = STOPPED;
                 }
                 euca_strncpy(res->nodeStatus, stateName, 24);
+                count_resourceCacheNode(i);
                 break;
             }
         }
@@ -4883,6 +6657,8 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
     int committing = 0;
     int rollback = 0;
     int found_instances = 0;
+    int planned = 0;
+    int *dst_indexes = NULL;
     ccResourceCache resourceCacheLocal;
     ccInstance **cc_instances = NULL;
     ncInstance **nc_instances = NULL;
@@ -4946,17 +6722,19 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
 
     sem_mywait(INSTCACHE);
     if (instanceCache->numInsts) {
-        for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
-            if (instanceCache->cacheState[i] == INSTVALID && (instanceId || instanceCache->instances[i].ncHostIdx == src_index)
-                && (!strcmp(instanceCache->instances[i].state, "Extant"))) {
+        // a whole node only needs the instances chained to it in the node index
+        for (i = (instanceId ? 0 : instanceCacheGroupNext(INSTGRP_NODE, NULL, src_index, -1)); (i >= 0) && (i < MAXINSTANCES_PER_CC);
+             i = (instanceId ? (i + 1) : instanceCacheGroupNext(INSTGRP_NODE, NULL, src_index, i))) {
+            if (instanceCache->cacheState[i] == INSTVALID && (instanceId || instanceCache->summaries[i].ncHostIdx == src_index)
+                && (!strcmp(instanceCache->summaries[i].state, "Extant"))) {
                 if (instanceId) {
                     // Only looking for a specific instance?
-                    if (strcmp(instanceCache->instances[i].instanceId, instanceId)) {
+                    if (strcmp(instanceCache->summaries[i].instanceId, instanceId)) {
                         // Yes, but this is not the one, so keep looking.
                         continue;
                     } else {
                         // Found our instance.
-                        src_index = instanceCache->instances[i].ncHostIdx;
+                        src_index = instanceCache->summaries[i].ncHostIdx;
                         LOGDEBUG("[%s] found instance running on node %s\n", instanceId, resourceCacheLocal.resources[src_index].hostname);
                     }
                 }
@@ -5005,6 +6783,16 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
     }
 
     if (preparing) {
+        // The whole batch is planned at once, reserving each destination's share as it is picked so that the
+        // instances of an evacuated node are spread over nodes that can actually take them all.
+        dst_indexes = EUCA_ZALLOC(found_instances, sizeof(int));
+        if (!dst_indexes) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
+        }
+
+        sem_mywait(RESCACHE);
+        sem_mywait(CONFIG);
         for (int idx = 0; idx < found_instances; idx++) {
             if (allowHosts) {
                 // destinationHosts is whitelist, pass as includeNodes.
@@ -5019,13 +6807,22 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
             }
 
             if (rc || (dst_index == -1)) {
-                LOGERROR("[%s] cannot schedule destination node for migration from source %s\n", nc_instances[idx]->instanceId, nc_instances[idx]->migration_src);
-                ret = 1;
-                goto out;
-            } else {
-                strncpy(nc_instances[idx]->migration_dst, resourceCacheLocal.resources[dst_index].hostname, HOSTNAME_SIZE);
-                LOGINFO("[%s] scheduled instance migration from %s to %s\n", nc_instances[idx]->instanceId, nc_instances[idx]->migration_src, nc_instances[idx]->migration_dst);
+                LOGERROR("[%s] cannot schedule destination node for migration from source %s (%d of %d instance[s] placed)\n", nc_instances[idx]->instanceId,
+                         nc_instances[idx]->migration_src, planned, found_instances);
+                break;
             }
+
+            strncpy(nc_instances[idx]->migration_dst, resourceCacheLocal.resources[dst_index].hostname, HOSTNAME_SIZE);
+            reserve_migration_capacity(dst_index, &(nc_instances[idx]->params), 1);
+            dst_indexes[planned++] = dst_index;
+            LOGINFO("[%s] scheduled instance migration from %s to %s\n", nc_instances[idx]->instanceId, nc_instances[idx]->migration_src, nc_instances[idx]->migration_dst);
+        }
+        sem_mypost(CONFIG);
+        sem_mypost(RESCACHE);
+
+        if (planned < found_instances) {
+            ret = 1;
+            goto out;
         }
     }
 
@@ -5039,14 +6836,14 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         }
         credentials[CREDENTIAL_SIZE - 1] = 0;
 
-        timeout = ncGetTimeout(time(NULL), OP_TIMEOUT, 1, 0);
+        timeout = ncGetTimeout(mono_time_sec(), OP_TIMEOUT, 1, 0);
         LOGDEBUG("about to ncClientCall source node '%s' with nc_instances (%s %d) [creds='%s'] %s\n",
                  SP(resourceCacheLocal.resources[src_index].hostname), nodeAction, found_instances, credentials, SP(found_instances == 1 ? nc_instances[0]->instanceId : ""));
 
         //Populate service metadata in request. Needed for ebs-volume attachment
         populateOutboundMeta(pMeta);
 
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[src_index].lockidx, resourceCacheLocal.resources[src_index].ncURL, "ncMigrateInstances",
+        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[src_index].lockidx, resourceCacheLocal.resources[src_index].ncURL, NC_OP_MIGRATE_INSTANCES,
                           nc_instances, found_instances, nodeAction, credentials);
         if (rc) {
             LOGERROR("failed: request to prepare migration[s] from source %s\n", resourceCacheLocal.resources[src_index].hostname);
@@ -5071,44 +6868,66 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
             }
         }
 
+        // The source holds these instances for migration now, so their reservations stay until the
+        // next poll of the destinations accounts for them.
+        planned = 0;
+
         // notify the destinations, but do it asynchronously so that we can return to caller.
         // (spec says only prepare call to source should block.)
         pid_t pid = fork();
         if (!pid) {
-            int inst_succ = 0;
             int inst_fail = 0;
+            int groupSize = 0;
+            int maxGroup = 0;
+            ncInstance **group = NULL;
+            ncFanoutState fan = { 0 };
 
-            timeout = ncGetTimeout(time(NULL), OP_TIMEOUT, 1, 0);
-            LOGDEBUG("about to ncClientCall destination node[s] with nc_instances (%s %d) [creds='%s']\n", nodeAction, found_instances, credentials);
-            for (int idx = 0; idx < found_instances; idx++) {
-                LOGDEBUG("[%s] about to ncClientCall destination node '%s' with nc_instances (%s %d) [creds='%s']\n",
-                         SP(nc_instances[idx]->instanceId), SP(nc_instances[idx]->migration_dst), nodeAction, 1, credentials);
+            group = EUCA_ZALLOC(found_instances, sizeof(ncInstance *));
+            if (!group) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
 
-                dst_index = -1;
-                for (int res_idx = 0; res_idx < resourceCacheLocal.numResources && (dst_index == -1); res_idx++) {
-                    if (!strcmp(resourceCacheLocal.resources[res_idx].hostname, nc_instances[idx]->migration_dst)) {
-                        dst_index = res_idx;
-                    }
+            for (int res_idx = 0; res_idx < resourceCacheLocal.numResources; res_idx++) {
+                for (groupSize = 0, i = 0; i < found_instances; i++) {
+                    groupSize += (dst_indexes[i] == res_idx);
                 }
+                maxGroup = MAX(maxGroup, groupSize);
+            }
 
-                if (dst_index < 0) {
-                    LOGERROR("[%s] failed: request to prepare migration. Invalid resource index -1.\n", nc_instances[idx]->instanceId);
-                    exit(1);
+            // one child per destination prepares all of that destination's instances, all destinations in parallel
+            nc_fanout_begin(&fan, resourceCacheLocal.numResources, -1);
+            fan.timeout = (OP_TIMEOUT - 5) * maxGroup;
+            for (int res_idx = 0; res_idx < resourceCacheLocal.numResources; res_idx++) {
+                for (groupSize = 0, i = 0; i < found_instances; i++) {
+                    if (dst_indexes[i] == res_idx)
+                        group[groupSize++] = nc_instances[i];
                 }
-                //Populate service metadata in request. Needed for ebs-volume attachment
-                populateOutboundMeta(pMeta);
+                if (!groupSize)
+                    continue;
 
-                rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[dst_index].lockidx, resourceCacheLocal.resources[dst_index].ncURL, "ncMigrateInstances",
-                                  &(nc_instances[idx]), 1, nodeAction, credentials);
-                if (rc) {
-                    LOGERROR("[%s] failed: request to prepare migration on destination %s\n", nc_instances[idx]->instanceId, resourceCacheLocal.resources[dst_index].hostname);
-                    ++inst_fail;
-                    //exit(1);
-                } else {
-                    ++inst_succ;
+                if ((pid = nc_fanout_fork(&fan, res_idx, FALSE)) < 0) {
+                    inst_fail += groupSize;
+                } else if (pid == 0) {
+                    LOGDEBUG("about to ncClientCall destination node '%s' with nc_instances (%s %d) [creds='%s']\n", resourceCacheLocal.resources[res_idx].hostname, nodeAction,
+                             groupSize, credentials);
+
+                    //Populate service metadata in request. Needed for ebs-volume attachment
+                    populateOutboundMeta(pMeta);
+
+                    timeout = ncGetTimeout(mono_time_sec(), OP_TIMEOUT, 1, 0) * groupSize;
+                    rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[res_idx].lockidx, resourceCacheLocal.resources[res_idx].ncURL, NC_OP_MIGRATE_INSTANCES,
+                                      group, groupSize, nodeAction, credentials);
+                    if (rc) {
+                        LOGERROR("failed: request to prepare %d migration[s] on destination %s\n", groupSize, resourceCacheLocal.resources[res_idx].hostname);
+                    }
+                    exit((rc) ? 1 : 0);
                 }
             }
-            LOGDEBUG("called destination nodes[s] to prepare for %d incoming migrations[s], %d call[s] succeeded, %d call[s] failed\n", found_instances, inst_succ, inst_fail);
+            nc_fanout_end(&fan);
+            EUCA_FREE(group);
+
+            LOGDEBUG("called destination node[s] to prepare for %d incoming migration[s], %d could not be sent\n", found_instances, inst_fail);
             exit(0);
         } else {
             // parent
@@ -5116,7 +6935,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         }
     } else if (committing) {
         // call commit on source
-        timeout = ncGetTimeout(time(NULL), OP_TIMEOUT, 1, 0);
+        timeout = ncGetTimeout(mono_time_sec(), OP_TIMEOUT, 1, 0);
         LOGDEBUG("about to ncClientCall source node '%s' with nc_instances (%s %d) %s\n",
                  SP(resourceCacheLocal.resources[src_index].hostname), nodeAction, found_instances, SP(found_instances == 1 ? nc_instances[0]->instanceId : ""));
 
@@ -5124,7 +6943,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         populateOutboundMeta(pMeta);
 
         // No need to send credentials with commit call: they were already passed to source and destination during prepare call.
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[src_index].lockidx, resourceCacheLocal.resources[src_index].ncURL, "ncMigrateInstances",
+        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[src_index].lockidx, resourceCacheLocal.resources[src_index].ncURL, NC_OP_MIGRATE_INSTANCES,
                           nc_instances, found_instances, nodeAction, NULL);
         if (rc) {
             LOGERROR("failed: request to commit migration on source\n");
@@ -5133,7 +6952,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         }
     } else if (rollback) {
         // call rollback on node--could be source or destination
-        timeout = ncGetTimeout(time(NULL), OP_TIMEOUT, 1, 0);
+        timeout = ncGetTimeout(mono_time_sec(), OP_TIMEOUT, 1, 0);
 
         dst_index = -1;
         for (int res_idx = 0; res_idx < resourceCacheLocal.numResources && (dst_index == -1); res_idx++) {
@@ -5160,7 +6979,7 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
         //Populate service metadata in request. Needed for ebs-volume attachment
         populateOutboundMeta(pMeta);
 
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[dst_index].lockidx, resourceCacheLocal.resources[dst_index].ncURL, "ncMigrateInstances",
+        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[dst_index].lockidx, resourceCacheLocal.resources[dst_index].ncURL, NC_OP_MIGRATE_INSTANCES,
                           nc_instances, found_instances, nodeAction, NULL);
         if (rc) {
             LOGERROR("failed: request to roll back migration on node\n");
@@ -5175,12 +6994,21 @@ int doMigrateInstances(ncMetadata * pMeta, char *actionNode, char *instanceId, c
     }
 
 out:
+    if (planned) {
+        // give back the capacity reserved for a batch that is not going ahead
+        sem_mywait(RESCACHE);
+        for (int z = 0; z < planned; z++) {
+            reserve_migration_capacity(dst_indexes[z], &(nc_instances[z]->params), -1);
+        }
+        sem_mypost(RESCACHE);
+    }
     for (int z = 0; z < found_instances; z++) {
         EUCA_FREE(cc_instances[z]);
         EUCA_FREE(nc_instances[z]);
     }
     EUCA_FREE(cc_instances);
     EUCA_FREE(nc_instances);
+    EUCA_FREE(dst_indexes);
 
     LOGTRACE("done\n");
 
@@ -5211,8 +7039,8 @@ int doStartInstance(ncMetadata * pMeta, char *instanceId)
     int timeout = 0;
     int done = 0;
     ccInstance *myInstance = NULL;
-    time_t op_start = time(NULL);
-    ccResourceCache resourceCacheLocal;
+    time_t op_start = mono_time_sec();
+    ccResource resourceLocal = { {0} };
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled())
@@ -5225,12 +7053,6 @@ int doStartInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
-
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
         if (myInstance) {
@@ -5241,13 +7063,17 @@ int doStartInstance(ncMetadata * pMeta, char *instanceId)
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (j = start; ((j < stop) && !done); j++) {
+        if (get_resourceCacheEntry(j, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, (stop - start), j);
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[j].lockidx, resourceCacheLocal.resources[j].ncURL, "ncStartInstance", instanceId);
+        rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_START_INSTANCE, instanceId);
         if (rc) {
             ret = 1;
         } else {
@@ -5283,8 +7109,8 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
     int timeout = 0;
     int done = 0;
     ccInstance *myInstance = NULL;
-    time_t op_start = time(NULL);
-    ccResourceCache resourceCacheLocal;
+    time_t op_start = mono_time_sec();
+    ccResource resourceLocal = { {0} };
 
     rc = initialize(pMeta, FALSE);
     if (rc || ccIsEnabled())
@@ -5297,12 +7123,6 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
         return (1);
     }
 
-    sem_mywait(RESCACHE);
-    {
-        memcpy(&resourceCacheLocal, resourceCache, sizeof(ccResourceCache));
-    }
-    sem_mypost(RESCACHE);
-
     if ((rc = find_instanceCacheId(instanceId, &myInstance)) == 0) {
         // found the instance in the cache
         if (myInstance) {
@@ -5313,13 +7133,17 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
         }
     } else {
         start = 0;
-        stop = resourceCacheLocal.numResources;
+        stop = get_resourceCacheSize();
     }
 
     done = 0;
     for (j = start; ((j < stop) && !done); j++) {
+        if (get_resourceCacheEntry(j, &resourceLocal) != EUCA_OK) {
+            break;
+        }
+
         timeout = ncGetTimeout(op_start, OP_TIMEOUT, (stop - start), j);
-        rc = ncClientCall(pMeta, timeout, resourceCacheLocal.resources[j].lockidx, resourceCacheLocal.resources[j].ncURL, "ncStopInstance", instanceId);
+        rc = ncClientCall(pMeta, timeout, resourceLocal.lockidx, resourceLocal.ncURL, NC_OP_STOP_INSTANCE, instanceId);
         if (rc) {
             ret = 1;
         } else {
@@ -5352,6 +7176,7 @@ int doStopInstance(ncMetadata * pMeta, char *instanceId)
 int setup_shared_buffer(void **buf, char *bufname, size_t bytes, sem_t ** lock, char *lockname, int mode)
 {
     int shd, rc, ret;
+    int flags = MAP_SHARED | (sharedBufferOpts.prefault ? MAP_POPULATE : 0);
 
     // create a lock and grab it
     *lock = sem_open(lockname, O_CREAT, 0644, 1);
@@ -5373,12 +7198,24 @@ int setup_shared_buffer(void **buf, char *bufname, size_t bytes, sem_t ** lock,
             sem_close(*lock);
             return (1);
         }
-        *buf = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, shd, 0);
+        *buf = mmap(0, bytes, PROT_READ | PROT_WRITE, flags, shd, 0);
     } else if (mode == SHARED_FILE) {
         char *tmpstr, path[EUCA_MAX_PATH];
         struct stat mystat;
         int fd;
 
+        if (sharedBufferOpts.hugepageDir[0] != '\0') {
+            if ((rc = setup_hugepage_buffer(buf, bufname, bytes)) == 0) {
+                sem_post(*lock);
+                return (0);
+            } else if (rc < 0) {
+                // other processes already use the hugepage segment, a regular file would not be shared with them
+                sem_post(*lock);
+                return (1);
+            }
+            fprintf(stderr, "WARNING: cannot back '%s' with hugepages from '%s', using a regular file\n", bufname, sharedBufferOpts.hugepageDir);
+        }
+
         tmpstr = getenv(EUCALYPTUS_ENV_VAR_NAME);
         if (!tmpstr) {
             snprintf(path, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/CC/%s", "", bufname);
@@ -5396,9 +7233,10 @@ int setup_shared_buffer(void **buf, char *bufname, size_t bytes, sem_t ** lock,
             if (mystat.st_size != bytes) {
                 rc = ftruncate(fd, bytes);
             }
-            *buf = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-            if (*buf == NULL) {
+            *buf = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags, fd, 0);
+            if ((*buf == NULL) || (*buf == MAP_FAILED)) {
                 fprintf(stderr, "ERROR: cannot mmap fd\n");
+                *buf = NULL;
                 ret = 1;
             }
             close(fd);
@@ -5408,6 +7246,122 @@ int setup_shared_buffer(void **buf, char *bufname, size_t bytes, sem_t ** lock,
     return (ret);
 }
 
+//!
+//! Maps a shared segment from a file in the hugetlbfs mount set by CC_SHARED_HUGEPAGES,
+//! its size rounded up to a whole number of huge pages. The pages are reserved when the
+//! first process maps the file, so running out of huge pages shows up right here.
+//!
+//! @param[out] buf     set to the mapped segment
+//! @param[in]  bufname name of the segment, appended to the mount path
+//! @param[in]  bytes   size of the segment
+//!
+//! @return 0 on success, 1 if the caller can fall back to a regular file (no other process
+//!         has the hugepage file), or -1 if the hugepage file exists but cannot be mapped
+//!
+//! @pre The caller holds the lock of the segment
+//!
+static int setup_hugepage_buffer(void **buf, char *bufname, size_t bytes)
+{
+    int fd = -1;
+    boolean created = FALSE;
+    size_t size = 0;
+    void *p = MAP_FAILED;
+    struct stat mystat = { 0 };
+    struct statfs fs = { 0 };
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, EUCA_MAX_PATH, "%s%s", sharedBufferOpts.hugepageDir, bufname);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) {
+        created = TRUE;
+    } else if ((fd = open(path, O_RDWR, 0600)) < 0) {
+        fprintf(stderr, "ERROR: cannot open/create '%s' to set up mmapped buffer\n", path);
+        return (1);
+    }
+
+    if (fstatfs(fd, &fs) || (fs.f_type != HUGETLBFS_MAGIC) || (fs.f_bsize <= 0)) {
+        fprintf(stderr, "ERROR: '%s' is not on a hugetlbfs mount\n", path);
+        close(fd);
+        if (created)
+            unlink(path);
+        return (created ? 1 : -1);
+    }
+
+    size = ((bytes + fs.f_bsize - 1) / fs.f_bsize) * fs.f_bsize;
+    if (!fstat(fd, &mystat) && (mystat.st_size != size)) {
+        if (ftruncate(fd, size)) {
+            fprintf(stderr, "WARNING: cannot size '%s' to %lu bytes\n", path, (unsigned long)size);
+        }
+    }
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | (sharedBufferOpts.prefault ? MAP_POPULATE : 0), fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "ERROR: cannot mmap '%s' (%lu bytes): %s\n", path, (unsigned long)size, strerror(errno));
+        if (created)
+            unlink(path);
+        return (created ? 1 : -1);
+    }
+
+    *buf = p;
+    return (0);
+}
+
+//!
+//! Looks a key up in the configuration files, for the settings needed before the
+//! configuration subsystem (which lives in a shared segment itself) is available
+//!
+//! @param[in] name the configuration key
+//!
+//! @return the value, to be freed by the caller, or NULL if the key is not set
+//!
+static char *shared_buffer_option(const char *name)
+{
+    int i = 0;
+    char *home = getenv(EUCALYPTUS_ENV_VAR_NAME);
+    char *value = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    const char *files[2] = { EUCALYPTUS_CONF_OVERRIDE_LOCATION, EUCALYPTUS_CONF_LOCATION };
+
+    for (i = 0; i < 2; i++) {
+        snprintf(path, EUCA_MAX_PATH, files[i], (home ? home : "/"));
+        if (get_conf_var(path, name, &value) == 1)
+            return (value);
+        EUCA_FREE(value);
+    }
+    return (NULL);
+}
+
+//!
+//! Reads CC_SHARED_HUGEPAGES, CC_SHARED_PREFAULT and CC_MAX_SENSOR_RESOURCES into
+//! sharedBufferOpts. These change the layout of the shared segments, so like the other
+//! restart keys they only take effect once every CC process is restarted.
+//!
+static void read_shared_buffer_options(void)
+{
+    int n = 0;
+    char *tmpstr = NULL;
+
+    if ((tmpstr = shared_buffer_option("CC_SHARED_HUGEPAGES")) != NULL) {
+        euca_strncpy(sharedBufferOpts.hugepageDir, tmpstr, sizeof(sharedBufferOpts.hugepageDir));
+        EUCA_FREE(tmpstr);
+    }
+
+    if ((tmpstr = shared_buffer_option("CC_SHARED_PREFAULT")) != NULL) {
+        sharedBufferOpts.prefault = (!strcmp(tmpstr, "Y") ? TRUE : FALSE);
+        EUCA_FREE(tmpstr);
+    }
+
+    if ((tmpstr = shared_buffer_option("CC_MAX_SENSOR_RESOURCES")) != NULL) {
+        n = atoi(tmpstr);
+        if ((n > 0) && (n <= MAX_SENSOR_RESOURCES)) {
+            sharedBufferOpts.maxSensorResources = n;
+        } else {
+            fprintf(stderr, "WARNING: CC_MAX_SENSOR_RESOURCES out of range (%d), using %d\n", n, MAX_SENSOR_RESOURCES);
+        }
+        EUCA_FREE(tmpstr);
+    }
+}
+
 //copy from cc config into message metadata.
 static int populateOutboundMeta(ncMetadata * pMeta)
 {
@@ -5713,162 +7667,628 @@ int ccCheckState(int clcTimer)
         }
     }
 
-    // shellouts
-    {
-        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, config->eucahome);
-        if (check_file(cmd)) {
-            LOGERROR("cannot find shellout '%s'\n", cmd);
-            ret++;
+    // shellouts
+    {
+        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, config->eucahome);
+        if (check_file(cmd)) {
+            LOGERROR("cannot find shellout '%s'\n", cmd);
+            ret++;
+        }
+
+        if (euca_execlp(NULL, "ip", "addr", "show", NULL) != EUCA_OK) {
+            LOGERROR("cannot run shellout 'ip addr show'\n");
+            ret++;
+        }
+    }
+    // filesystem
+
+    // network
+    // arbitrators
+    if (clcTimer == 1 && strlen(config->arbitrators)) {
+        char *tok, buf[256], *host;
+        uint32_t hostint;
+        int count = 0;
+        int arbitratorFails = 0;
+        snprintf(buf, 255, "%s", config->arbitrators);
+        tok = strtok(buf, " ");
+        while (tok && count < 3) {
+            hostint = dot2hex(tok);
+            host = hex2dot(hostint);
+            if (host) {
+                LOGDEBUG("checking health of arbitrator (%s)\n", tok);
+                if ((rc = euca_execlp(NULL, "ping", "-c", "1", host, NULL)) != EUCA_OK) {
+                    LOGDEBUG("cannot ping arbitrator %s (ping rc=%d)\n", host, rc);
+                    arbitratorFails++;
+                }
+                EUCA_FREE(host);
+            }
+            tok = strtok(NULL, " ");
+            count++;
+        }
+        if (arbitratorFails) {
+            config->arbitratorFails++;
+        } else {
+            config->arbitratorFails = 0;
+        }
+
+        if (config->arbitratorFails > 10) {
+            LOGDEBUG("more than 10 arbitrator ping fails in a row (%d), failing check\n", config->arbitratorFails);
+            ret++;
+        }
+    }
+    // broker pairing algo
+    rc = doBrokerPairing();
+    if (rc) {
+        ret++;
+    }
+
+    snprintf(localDetails, 1023, "ERRORS=%d", ret);
+    snprintf(config->ccStatus.details, 1023, "%s", localDetails);
+
+    return (ret);
+}
+
+//!
+//!
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int doBrokerPairing(void)
+{
+    int ret, local_broker_down, i, is_ha_cc, port;
+    char buri[EUCA_MAX_PATH], uriType[32], bhost[EUCA_MAX_PATH], path[EUCA_MAX_PATH], curi[EUCA_MAX_PATH], chost[EUCA_MAX_PATH];
+
+    ret = 0;
+    local_broker_down = 0;
+    is_ha_cc = 0;
+
+    snprintf(curi, EUCA_MAX_PATH, "%s", config->ccStatus.serviceId.uris[0]);
+    bzero(chost, sizeof(char) * EUCA_MAX_PATH);
+    tokenize_uri(curi, uriType, chost, &port, path);
+
+    //enabled
+    for (i = 0; i < 16; i++) {
+        if (!strcmp(config->ccStatus.serviceId.name, "self")) {
+            //      LOGDEBUG("local CC service info not yet initialized\n");
+        } else if (!memcmp(&(config->ccStatus.serviceId), &(config->services[i]), sizeof(serviceInfoType))) {
+            //      LOGDEBUG("found local CC information in services()\n");
+        } else if (!strcmp(config->services[i].type, "cluster") && !strcmp(config->services[i].partition, config->ccStatus.serviceId.partition)) {
+            // service is not 'me', but is a 'cluster' and in has the same 'partition', must be in HA mode
+            //      LOGDEBUG("CC is in HA mode\n");
+            is_ha_cc = 1;
+        }
+    }
+    //disabled
+    for (i = 0; i < 16; i++) {
+        if (!strcmp(config->ccStatus.serviceId.name, "self")) {
+            //      LOGDEBUG("local CC service info not yet initialized\n");
+        } else if (!memcmp(&(config->ccStatus.serviceId), &(config->disabledServices[i]), sizeof(serviceInfoType))) {
+            //      LOGDEBUG("found local CC information in disabled services()\n");
+        } else if (!strcmp(config->disabledServices[i].type, "cluster")
+                   && !strcmp(config->disabledServices[i].partition, config->ccStatus.serviceId.partition)) {
+            // service is not 'me', but is a 'cluster' and in has the same 'partition', must be in HA mode
+            //      LOGDEBUG("CC is in HA mode\n");
+            is_ha_cc = 1;
+        }
+    }
+    //notready
+    for (i = 0; i < 16; i++) {
+        int j;
+        //test
+        if (!strcmp(config->ccStatus.serviceId.name, "self")) {
+            //      LOGDEBUG("local CC service info not yet initialized\n");
+        } else if (!memcmp(&(config->ccStatus.serviceId), &(config->notreadyServices[i]), sizeof(serviceInfoType))) {
+            //      LOGDEBUG("found local CC information in notreadyServices()\n");
+        } else if (!strcmp(config->notreadyServices[i].type, "cluster")
+                   && !strcmp(config->notreadyServices[i].partition, config->ccStatus.serviceId.partition)) {
+            // service is not 'me', but is a 'cluster' and in has the same 'partition', must be in HA mode
+            //      LOGDEBUG("CC is in HA mode\n");
+            is_ha_cc = 1;
+        }
+
+        if (strlen(config->notreadyServices[i].type)) {
+            if (!strcmp(config->notreadyServices[i].type, "vmwarebroker")) {
+                for (j = 0; j < MAX_SERVICE_URIS; j++) {
+                    if (strlen(config->notreadyServices[i].uris[j])) {
+                        LOGDEBUG("found broker - %s\n", config->notreadyServices[i].uris[j]);
+
+                        snprintf(buri, EUCA_MAX_PATH, "%s", config->notreadyServices[i].uris[j]);
+                        bzero(bhost, sizeof(char) * EUCA_MAX_PATH);
+                        tokenize_uri(buri, uriType, bhost, &port, path);
+
+                        LOGDEBUG("comparing found not ready broker host (%s) with local CC host (%s)\n", bhost, chost);
+                        if (!strcmp(chost, bhost)) {
+                            LOGWARN("detected local broker (%s) matching local CC (%s) in NOTREADY state\n", bhost, chost);
+                            //          ret++;
+                            local_broker_down = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (local_broker_down && is_ha_cc) {
+        LOGDEBUG("detected CC in HA mode, and local broker is not ENABLED\n");
+        ret++;
+    }
+    return (ret);
+}
+
+//! The monitor tasks, indexed by MONITOR_TASK_*
+static const monitorTaskDef monitorTasks[MONITOR_TASK_LAST] = {
+    {"refresh_resources", monitor_run_resources, monitor_period_nc_poll, 90, FALSE},
+    {"refresh_instances", monitor_run_instances, monitor_period_nc_poll, 90, FALSE},
+    {"refresh_sensors", monitor_run_sensors, monitor_period_sensors, 90, TRUE},
+    {"broadcast_network_info", monitor_run_broadcast, monitor_period_second, 90, FALSE},
+    {"maintain_network_state", monitor_run_network, monitor_period_nc, 60, FALSE},
+    {"sync_clc_network", monitor_run_clc, monitor_period_clc, 60, FALSE},
+    {"image_cache_proxy", monitor_run_proxy, monitor_period_second, 30, FALSE},
+    {"consolidate_nodes", monitor_run_consolidate, monitor_period_idle, OP_TIMEOUT, FALSE},
+    {"monitor_summary", monitor_run_summary, monitor_period_summary, 10, FALSE},
+    {"instance_events", monitor_run_events, monitor_period_second, 10, FALSE},
+};
+
+//! @{
+//! @name the monitor tasks, see monitorTasks[]
+
+static time_t monitor_period_nc(void)
+{
+    return (config->ncPollingFrequency);
+}
+
+static time_t monitor_period_nc_poll(void)
+{
+    // each node is polled at its own interval, see nc_poll_due()
+    return (config->ncPollingMin);
+}
+
+static time_t monitor_period_clc(void)
+{
+    return (config->clcPollingFrequency);
+}
+
+static time_t monitor_period_sensors(void)
+{
+    return (config->ncSensorsPollingInterval);
+}
+
+static time_t monitor_period_second(void)
+{
+    return (1);
+}
+
+static time_t monitor_period_summary(void)
+{
+    return (LOG_INTERVAL_SUMMARY_SEC);
+}
+
+static time_t monitor_period_idle(void)
+{
+    return (config->idleThresh);
+}
+
+static int monitor_run_resources(ncMetadata * pMeta)
+{
+    int rc = refresh_resources(pMeta, 60, 1);
+
+    if (rc) {
+        LOGWARN("call to refresh_resources() failed in monitor thread\n");
+    }
+    return (rc);
+}
+
+static int monitor_run_instances(ncMetadata * pMeta)
+{
+    int rc = refresh_instances(pMeta, 60, 1);
+
+    if (rc) {
+        LOGWARN("call to refresh_instances() failed in monitor thread\n");
+    }
+
+    checkpoint_snapshot(FALSE);
+    return (rc);
+}
+
+static int monitor_run_sensors(ncMetadata * pMeta)
+{
+    // refresh_sensors() only returns non-zero when sensor subsystem has not been initialized.
+    // Until it is initialized, keep checking every second, so that sensory subsystems on NCs are
+    // initialized soon after it is initialized on the CC (otherwise it may take a while and NC
+    // may miss initial measurements from early instances). Once initialized, refresh can happen
+    // as configured by config->ncSensorsPollingInterval.
+    return (refresh_sensors(pMeta, 60, 1));
+}
+
+static int monitor_run_broadcast(ncMetadata * pMeta)
+{
+    int rc = 0;
+
+    if (config->kick_broadcast_network_info) {
+        rc = broadcast_network_info(pMeta, 60, 1);
+        if (rc) {
+            LOGWARN("call to broadcast_network_info() failed in monitor thread\n");
+        }
+        config->kick_broadcast_network_info = 0;
+    }
+    return (rc);
+}
+
+static int monitor_run_network(ncMetadata * pMeta)
+{
+    int rc = 0;
+    int ret = 0;
+
+    if (is_clean_instanceCache()) {
+        // Network state operations
+        LOGDEBUG("syncing network state\n");
+        rc = syncNetworkState();
+        if (rc) {
+            LOGDEBUG("syncNetworkState() triggering network restore\n");
+            config->kick_network = 1;
+        }
+
+        if (config->kick_network) {
+            LOGDEBUG("restoring network state\n");
+            rc = restoreNetworkState();
+            if (rc) {
+                // failed to restore network state, continue
+                LOGWARN("restoreNetworkState returned false (may be already restored)\n");
+            } else {
+                sem_mywait(CONFIG);
+                config->kick_network = 0;
+                sem_mypost(CONFIG);
+            }
+        }
+    } else {
+        LOGDEBUG("instanceCache is dirty, skipping network update\n");
+    }
+
+    LOGDEBUG("maintaining network state\n");
+    if ((ret = maintainNetworkState()) != 0) {
+        LOGERROR("network state maintainance failed\n");
+    }
+    return (ret);
+}
+
+static int monitor_run_clc(ncMetadata * pMeta)
+{
+    int rc = 0;
+
+    LOGDEBUG("syncing CLC network rules ground truth with local state\n");
+    if ((rc = reconfigureNetworkFromCLC()) != 0) {
+        LOGWARN("cannot get network ground truth from CLC\n");
+    }
+    return (rc);
+}
+
+static int monitor_run_proxy(ncMetadata * pMeta)
+{
+    int ret = 0;
+    char dataDir[EUCA_MAX_PATH] = "";
+
+    if (!config->use_proxy)
+        return (0);
+
+    if (image_cache_invalidate()) {
+        LOGERROR("cannot invalidate image cache\n");
+        ret++;
+    }
+
+    // the downloads are served by threads of this worker, which stays around for as long as the monitor
+    if (!image_proxy_running()) {
+        snprintf(dataDir, EUCA_MAX_PATH, "%s/data", config->proxyPath);
+        if (image_proxy_start(IMAGE_PROXY_PORT, dataDir, image_proxy_node_allowed) != EUCA_OK) {
+            LOGERROR("could not start proxy cache\n");
+            ret++;
+        }
+    }
+    return (ret);
+}
+
+//! Only the nodes of this cluster may download from the image proxy
+static boolean image_proxy_node_allowed(const char *ip)
+{
+    int i = 0;
+    boolean known = FALSE;
+
+    sem_mywait(RESCACHE);
+    for (i = 0; (i < resourceCache->numResources) && strcmp(resourceCache->resources[i].ip, ip); i++) ;
+    known = (i < resourceCache->numResources);
+    sem_mypost(RESCACHE);
+    return (known);
+}
+
+static int monitor_run_consolidate(ncMetadata * pMeta)
+{
+    int i = 0;
+    int rc = 0;
+    int src = -1;
+    int ndst = 0;
+    int numInsts = 0;
+    int dsts[MAXNODES] = { 0 };
+    char srcHost[HOSTNAME_SIZE] = "";
+    char **dstHosts = NULL;
+    schedInstance *insts = NULL;
+
+    if ((config->schedPolicy != SCHEDPOWERSAVE) || (config->consolidateThresh <= 0))
+        return (0);
+
+    if ((insts = EUCA_ZALLOC(MAXINSTANCES_PER_CC, sizeof(schedInstance))) == NULL) {
+        LOGERROR("out of memory!\n");
+        return (1);
+    }
+
+    sem_mywait(INSTCACHE);
+    if (instanceCache->numInsts) {
+        for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
+            if ((instanceCache->cacheState[i] != INSTVALID) || strcmp(instanceCache->summaries[i].state, "Extant"))
+                continue;
+            insts[numInsts].resid = instanceCache->summaries[i].ncHostIdx;
+            insts[numInsts].mem = instanceCache->instances[i].ccvm.mem;
+            insts[numInsts].disk = instanceCache->instances[i].ccvm.disk;
+            insts[numInsts].cores = instanceCache->instances[i].ccvm.cores;
+            insts[numInsts].migrating = (instanceCache->summaries[i].migration_state != NOT_MIGRATING);
+            numInsts++;
+        }
+    }
+    sem_mypost(INSTCACHE);
+
+    sem_mywait(RESCACHE);
+    sem_mywait(CONFIG);
+    if ((ndst = sched_power_consolidate(insts, numInsts, &src, dsts)) > 0) {
+        euca_strncpy(srcHost, resourceCache->resources[src].hostname, HOSTNAME_SIZE);
+        if ((dstHosts = EUCA_ZALLOC(ndst, sizeof(char *))) != NULL) {
+            for (i = 0; i < ndst; i++) {
+                dstHosts[i] = strdup(resourceCache->resources[dsts[i]].hostname);
+            }
         }
+    }
+    sem_mypost(CONFIG);
+    sem_mypost(RESCACHE);
+    EUCA_FREE(insts);
 
-        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_HELPER_DIR "/dynserv.pl", config->eucahome);
-        if (check_file(cmd)) {
-            LOGERROR("cannot find shellout '%s'\n", cmd);
-            ret++;
+    if (dstHosts) {
+        // the planned destinations are passed as the allowed ones, the instances are placed on them again as the migration is prepared
+        if ((rc = doMigrateInstances(pMeta, srcHost, NULL, dstHosts, ndst, 1, "prepare")) != 0) {
+            LOGWARN("could not consolidate the instances of %s: %s\n", srcHost, SP(pMeta->replyString));
         }
+        EUCA_FREE(pMeta->replyString);
 
-        if (euca_execlp(NULL, "ip", "addr", "show", NULL) != EUCA_OK) {
-            LOGERROR("cannot run shellout 'ip addr show'\n");
-            ret++;
+        for (i = 0; i < ndst; i++) {
+            EUCA_FREE(dstHosts[i]);
         }
+        EUCA_FREE(dstHosts);
     }
-    // filesystem
+    return (rc);
+}
 
-    // network
-    // arbitrators
-    if (clcTimer == 1 && strlen(config->arbitrators)) {
-        char *tok, buf[256], *host;
-        uint32_t hostint;
-        int count = 0;
-        int arbitratorFails = 0;
-        snprintf(buf, 255, "%s", config->arbitrators);
-        tok = strtok(buf, " ");
-        while (tok && count < 3) {
-            hostint = dot2hex(tok);
-            host = hex2dot(hostint);
-            if (host) {
-                LOGDEBUG("checking health of arbitrator (%s)\n", tok);
-                if ((rc = euca_execlp(NULL, "ping", "-c", "1", host, NULL)) != EUCA_OK) {
-                    LOGDEBUG("cannot ping arbitrator %s (ping rc=%d)\n", host, rc);
-                    arbitratorFails++;
-                }
-                EUCA_FREE(host);
-            }
-            tok = strtok(NULL, " ");
-            count++;
-        }
-        if (arbitratorFails) {
-            config->arbitratorFails++;
+static int monitor_run_summary(ncMetadata * pMeta)
+{
+    int i = 0;
+    int res_idle = 0, res_busy = 0, res_bad = 0;
+    int num_pending = 0, num_extant = 0, num_teardown = 0;
+    ccMonitorTask *task = NULL;
+
+    // print a periodic summary of instances in the log
+    sem_mywait(RESCACHE);
+    for (i = 0; i < resourceCache->numResources; i++) {
+        ccResource *res = &(resourceCache->resources[i]);
+        if (res->state == RESDOWN) {
+            res_bad++;
         } else {
-            config->arbitratorFails = 0;
+            if (res->maxCores != res->availCores) {
+                res_busy++;
+            } else {
+                res_idle++;
+            }
         }
+    }
+    sem_mypost(RESCACHE);
 
-        if (config->arbitratorFails > 10) {
-            LOGDEBUG("more than 10 arbitrator ping fails in a row (%d), failing check\n", config->arbitratorFails);
-            ret++;
+    sem_mywait(INSTCACHE);
+    if (instanceCache->numInsts) {
+        for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
+            if (!strcmp(instanceCache->summaries[i].state, "Pending")) {
+                num_teardown++;
+            } else if (!strcmp(instanceCache->summaries[i].state, "Extant")) {
+                num_extant++;
+            } else if (!strcmp(instanceCache->summaries[i].state, "Teardown")) {
+                num_teardown++;
+            }
         }
     }
-    // broker pairing algo
-    rc = doBrokerPairing();
-    if (rc) {
-        ret++;
-    }
+    sem_mypost(INSTCACHE);
 
-    snprintf(localDetails, 1023, "ERRORS=%d", ret);
-    snprintf(config->ccStatus.details, 1023, "%s", localDetails);
+    LOGINFO("instances: %04d (%04d extant + %04d pending + %04d terminated)\n", (num_pending + num_extant + num_teardown), num_extant, num_pending, num_teardown);
+    LOGINFO("    nodes: %04d (%04d busy + %04d idle + %04d unresponsive)\n", (res_busy + res_idle + res_bad), res_busy, res_idle, res_bad);
 
-    return (ret);
+    sem_mywait(RESCACHE);
+    for (i = 0; i < resourceCache->numResources; i++) {
+        print_ncLatency(&(resourceCache->resources[i]));
+    }
+    sem_mypost(RESCACHE);
+
+    for (i = 0; i < MONITOR_TASK_LAST; i++) {
+        task = &(config->monitorTasks[i]);
+        LOGINFO("     task: %-22s runs=%lld last=%ldms max=%ldms skipped=%lld overruns=%lld%s\n", monitorTasks[i].name, task->runs, task->lastDuration,
+                task->maxDuration, task->skipped, task->overruns, (task->running ? " (running)" : ""));
+    }
+    return (0);
 }
 
-//!
-//!
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
-//!
-int doBrokerPairing(void)
+static int monitor_run_events(ncMetadata * pMeta)
 {
-    int ret, local_broker_down, i, is_ha_cc, port;
-    char buri[EUCA_MAX_PATH], uriType[32], bhost[EUCA_MAX_PATH], path[EUCA_MAX_PATH], curi[EUCA_MAX_PATH], chost[EUCA_MAX_PATH];
+    int i = 0;
+    int rc = 0;
+    int num = 0;
+    int known = 0;
+    ssize_t len = 0;
+    char msg[64] = "";
+    char from[INET_ADDRSTRLEN] = "";
+    socklen_t addrlen = 0;
+    struct sockaddr_in addr = { 0 };
+    struct pollfd pfd = { 0 };
+    static int fd = -1;
+
+    // the NCs announce changes of their instances, see announce_instance_changes() on the NC,
+    // each one only makes the instances get refreshed before their next poll is due
+    if (fd < 0) {
+        if ((fd = socket(AF_INET, (SOCK_DGRAM | SOCK_CLOEXEC), 0)) < 0) {
+            LOGWARN("cannot create socket for instance announcements: %s\n", strerror(errno));
+            return (1);
+        }
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(config->eventPort);
+        if (bind(fd, ((struct sockaddr *)&addr), sizeof(addr)) < 0) {
+            LOGWARN("cannot listen for instance announcements on UDP port %d, relying on polling: %s\n", config->eventPort, strerror(errno));
+            close(fd);
+            fd = -1;
+            return (1);
+        }
+        LOGDEBUG("listening for instance announcements on UDP port %d\n", config->eventPort);
+    }
 
-    ret = 0;
-    local_broker_down = 0;
-    is_ha_cc = 0;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if ((rc = poll(&pfd, 1, 1000)) <= 0)
+        return (0);
 
-    snprintf(curi, EUCA_MAX_PATH, "%s", config->ccStatus.serviceId.uris[0]);
-    bzero(chost, sizeof(char) * EUCA_MAX_PATH);
-    tokenize_uri(curi, uriType, chost, &port, path);
+    // drain everything queued up, any number of announcements makes for one refresh
+    for (;;) {
+        addrlen = sizeof(addr);
+        if ((len = recvfrom(fd, msg, (sizeof(msg) - 1), MSG_DONTWAIT, ((struct sockaddr *)&addr), &addrlen)) < 0)
+            break;
+        msg[len] = '\0';
+        if (!inet_ntop(AF_INET, &(addr.sin_addr), from, sizeof(from)))
+            continue;
 
-    //enabled
-    for (i = 0; i < 16; i++) {
-        if (!strcmp(config->ccStatus.serviceId.name, "self")) {
-            //      LOGDEBUG("local CC service info not yet initialized\n");
-        } else if (!memcmp(&(config->ccStatus.serviceId), &(config->services[i]), sizeof(serviceInfoType))) {
-            //      LOGDEBUG("found local CC information in services()\n");
-        } else if (!strcmp(config->services[i].type, "cluster") && !strcmp(config->services[i].partition, config->ccStatus.serviceId.partition)) {
-            // service is not 'me', but is a 'cluster' and in has the same 'partition', must be in HA mode
-            //      LOGDEBUG("CC is in HA mode\n");
-            is_ha_cc = 1;
-        }
-    }
-    //disabled
-    for (i = 0; i < 16; i++) {
-        if (!strcmp(config->ccStatus.serviceId.name, "self")) {
-            //      LOGDEBUG("local CC service info not yet initialized\n");
-        } else if (!memcmp(&(config->ccStatus.serviceId), &(config->disabledServices[i]), sizeof(serviceInfoType))) {
-            //      LOGDEBUG("found local CC information in disabled services()\n");
-        } else if (!strcmp(config->disabledServices[i].type, "cluster")
-                   && !strcmp(config->disabledServices[i].partition, config->ccStatus.serviceId.partition)) {
-            // service is not 'me', but is a 'cluster' and in has the same 'partition', must be in HA mode
-            //      LOGDEBUG("CC is in HA mode\n");
-            is_ha_cc = 1;
+        // only the nodes of this cluster are listened to
+        sem_mywait(RESCACHE);
+        for (i = 0; (i < resourceCache->numResources) && strcmp(resourceCache->resources[i].ip, from); i++) ;
+        known = (i < resourceCache->numResources);
+        if (known)
+            resourceCache->resources[i].lastInstPoll = 0;
+        sem_mypost(RESCACHE);
+
+        if (!known) {
+            LOGTRACE("ignoring instance announcement '%s' from %s, not a node of this cluster\n", msg, from);
+            continue;
         }
+        LOGTRACE("node %s announced '%s'\n", from, msg);
+        num++;
     }
-    //notready
-    for (i = 0; i < 16; i++) {
-        int j;
-        //test
-        if (!strcmp(config->ccStatus.serviceId.name, "self")) {
-            //      LOGDEBUG("local CC service info not yet initialized\n");
-        } else if (!memcmp(&(config->ccStatus.serviceId), &(config->notreadyServices[i]), sizeof(serviceInfoType))) {
-            //      LOGDEBUG("found local CC information in notreadyServices()\n");
-        } else if (!strcmp(config->notreadyServices[i].type, "cluster")
-                   && !strcmp(config->notreadyServices[i].partition, config->ccStatus.serviceId.partition)) {
-            // service is not 'me', but is a 'cluster' and in has the same 'partition', must be in HA mode
-            //      LOGDEBUG("CC is in HA mode\n");
-            is_ha_cc = 1;
-        }
 
-        if (strlen(config->notreadyServices[i].type)) {
-            if (!strcmp(config->notreadyServices[i].type, "vmwarebroker")) {
-                for (j = 0; j < MAX_SERVICE_URIS; j++) {
-                    if (strlen(config->notreadyServices[i].uris[j])) {
-                        LOGDEBUG("found broker - %s\n", config->notreadyServices[i].uris[j]);
+    if (num > 0) {
+        LOGDEBUG("refreshing instances of the nodes that sent %d announcement(s)\n", num);
+        config->monitorTasks[MONITOR_TASK_INSTANCES].kicked = 1;
+    }
+    return (0);
+}
 
-                        snprintf(buri, EUCA_MAX_PATH, "%s", config->notreadyServices[i].uris[j]);
-                        bzero(bhost, sizeof(char) * EUCA_MAX_PATH);
-                        tokenize_uri(buri, uriType, bhost, &port, path);
+//! @}
 
-                        LOGDEBUG("comparing found not ready broker host (%s) with local CC host (%s)\n", bhost, chost);
-                        if (!strcmp(chost, bhost)) {
-                            LOGWARN("detected local broker (%s) matching local CC (%s) in NOTREADY state\n", bhost, chost);
-                            //          ret++;
-                            local_broker_down = 1;
-                        }
-                    }
+//!
+//! Runs a monitor task at its period, for as long as the monitor process is around. The
+//! task only runs while the CC is enabled. A run that is still going when the next one is
+//! due makes that cycle (and any other it overlaps) get skipped rather than queued.
+//!
+//! @param[in] task the monitor task, MONITOR_TASK_*
+//! @param[in] monitor the monitor process
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//!
+static void monitor_task_worker(int task, pid_t monitor, ncMetadata * pMeta)
+{
+    int rc = 0;
+    long elapsed = 0;
+    time_t now = 0;
+    time_t period = 0;
+    long long start = 0;
+    long long skip = 0;
+    const monitorTaskDef *def = &(monitorTasks[task]);
+    ccMonitorTask *state = &(config->monitorTasks[task]);
+
+    LOGDEBUG("monitor task %s running\n", def->name);
+    while (getppid() == monitor) {
+        now = time(NULL);
+        if ((config->ccState == ENABLED) && ((now >= state->nextRun) || state->kicked)) {
+            state->kicked = 0;
+            state->lastStart = start = mono_time_ms();
+            state->running = 1;
+            rc = def->run(pMeta);
+            state->lastEnd = mono_time_ms();
+            state->running = 0;
+
+            elapsed = (long)(state->lastEnd - start);
+            state->lastDuration = elapsed;
+            if (elapsed > state->maxDuration)
+                state->maxDuration = elapsed;
+            if (elapsed > (def->deadline * 1000)) {
+                state->overruns++;
+                LOGWARN("monitor task %s took %ldms, past its %lds deadline\n", def->name, elapsed, (long)def->deadline);
+            }
+            state->lastRc = rc;
+            state->runs++;
+            cached_message_stats_update(def->name, elapsed, rc);
+
+            period = def->period();
+            if (period < 1)
+                period = 1;
+
+            if (rc && def->retry) {
+                state->nextRun = now + MONITOR_TASK_RETRY_SEC;
+            } else {
+                state->nextRun = now + period;
+                if ((now = time(NULL)) >= state->nextRun) {
+                    skip = ((now - state->nextRun) / period) + 1;
+                    state->skipped += skip;
+                    state->nextRun += (skip * period);
+                    LOGDEBUG("monitor task %s skipped %lld cycle(s) while running\n", def->name, skip);
                 }
             }
+
+            // clean up after the children of the run
+            shawn();
         }
+        sleep(1);
     }
 
-    if (local_broker_down && is_ha_cc) {
-        LOGDEBUG("detected CC in HA mode, and local broker is not ENABLED\n");
-        ret++;
+    LOGDEBUG("monitor task %s exiting, monitor process %d is gone\n", def->name, monitor);
+}
+
+//!
+//! Starts the worker process of a monitor task, unless it is already running
+//!
+//! @param[in] task the monitor task, MONITOR_TASK_*
+//! @param[in] pMeta a pointer to the node controller (NC) metadata structure
+//!
+static void monitor_task_start(int task, ncMetadata * pMeta)
+{
+    int pid = 0;
+    pid_t monitor = getpid();
+    ccMonitorTask *state = &(config->monitorTasks[task]);
+
+    if (state->pid && !check_process(state->pid, NULL))
+        return;
+
+    if ((pid = fork()) == 0) {
+        monitor_task_worker(task, monitor, pMeta);
+        exit(0);
     }
-    return (ret);
+
+    if (pid < 0) {
+        LOGERROR("cannot start the worker of monitor task %s\n", monitorTasks[task].name);
+        return;
+    }
+
+    // a run the previous worker did not finish is not coming back
+    state->pid = pid;
+    state->running = 0;
 }
 
 //!
@@ -5877,6 +8297,11 @@ int doBrokerPairing(void)
 //! and describeResources calls to the CC.  The purpose of this separation is to allow for a more scalable
 //! framework where describe operations do not block on access to node controllers.
 //!
+//! The polling itself is split into the tasks of monitorTasks[], each run by its own worker process
+//! at its own period, so that a slow task (a sensor refresh, say) does not hold up the others. This
+//! process starts the workers (again, if one dies), keeps the CC state and reports runs that go past
+//! their deadline.
+//!
 //! @param[in] in
 //!
 //! @return
@@ -5887,9 +8312,12 @@ int doBrokerPairing(void)
 //!
 void *monitor_thread(void *in)
 {
-    int rc, ncTimer, clcTimer, ncSensorsTimer, ncRefresh = 0, clcRefresh = 0, ncSensorsRefresh = 0;
+    int i, rc, clcTimer;
+    long long enabled_ms = 0;
+    long long now_ms = 0;
     ncMetadata pMeta;
-    char pidfile[EUCA_MAX_PATH], *pidstr = NULL;
+    ccMonitorTask *task = NULL;
+    boolean overrun[MONITOR_TASK_LAST] = { FALSE };
 
     bzero(&pMeta, sizeof(ncMetadata));
     pMeta.correlationId = strdup("monitor");
@@ -5906,190 +8334,53 @@ void *monitor_thread(void *in)
     sigprocmask(SIG_SETMASK, &newsigact.sa_mask, NULL);
     sigaction(SIGTERM, &newsigact, NULL);
 
-    // add 1 to each Timer so they will all fire upon the first loop iteration
-    ncTimer = config->ncPollingFrequency + 1;
-    clcTimer = config->clcPollingFrequency + 1;
-    ncSensorsTimer = config->ncSensorsPollingInterval + 1;
-
-    while (1) {
-        LOGTRACE("running\n");
-
-        if (config->kick_enabled) {
-            ccChangeState(ENABLED);
-            config->kick_enabled = 0;
-        }
-
-        rc = update_config();
-        if (rc) {
-            LOGWARN("bad return from update_config(), check your config file\n");
-        }
-
-        if (config->ccState == ENABLED) {
-
-            // NC Polling operations
-            if (ncTimer >= config->ncPollingFrequency) {
-                ncTimer = 0;
-                ncRefresh = 1;
-            }
-            ncTimer++;
-
-            // CLC Polling operations
-            if (clcTimer >= config->clcPollingFrequency) {
-                clcTimer = 0;
-                clcRefresh = 1;
-            }
-            clcTimer++;
-
-            // NC Sensors Polling operation
-            if (ncSensorsTimer >= config->ncSensorsPollingInterval) {
-                ncSensorsTimer = 0;
-                ncSensorsRefresh = 1;
-            }
-            ncSensorsTimer++;
-
-            if (ncRefresh) {
-                rc = refresh_resources(&pMeta, 60, 1);
-                if (rc) {
-                    LOGWARN("call to refresh_resources() failed in monitor thread\n");
-                }
-
-                rc = refresh_instances(&pMeta, 60, 1);
-                if (rc) {
-                    LOGWARN("call to refresh_instances() failed in monitor thread\n");
-                }
-            }
-
-            if (config->kick_broadcast_network_info) {
-                rc = broadcast_network_info(&pMeta, 60, 1);
-                if (rc) {
-                    LOGWARN("call to broadcast_network_info() failed in monitor thread\n");
-                }
-                config->kick_broadcast_network_info = 0;
-            }
-
-            {                          // print a periodic summary of instances in the log
-                static time_t last_log_update = 0;
-
-                int res_idle = 0, res_busy = 0, res_bad = 0;
-                sem_mywait(RESCACHE);
-                for (int i = 0; i < resourceCache->numResources; i++) {
-                    ccResource *res = &(resourceCache->resources[i]);
-                    if (res->state == RESDOWN) {
-                        res_bad++;
-                    } else {
-                        if (res->maxCores != res->availCores) {
-                            res_busy++;
-                        } else {
-                            res_idle++;
-                        }
-                    }
-                }
-                sem_mypost(RESCACHE);
-
-                int num_pending = 0, num_extant = 0, num_teardown = 0;
-                sem_mywait(INSTCACHE);
-                if (instanceCache->numInsts) {
-                    for (int i = 0; i < MAXINSTANCES_PER_CC; i++) {
-                        if (!strcmp(instanceCache->instances[i].state, "Pending")) {
-                            num_teardown++;
-                        } else if (!strcmp(instanceCache->instances[i].state, "Extant")) {
-                            num_extant++;
-                        } else if (!strcmp(instanceCache->instances[i].state, "Teardown")) {
-                            num_teardown++;
-                        }
-                    }
-                }
-                sem_mypost(INSTCACHE);
-
-                time_t now = time(NULL);
-                if ((now - last_log_update) > LOG_INTERVAL_SUMMARY_SEC) {
-                    last_log_update = now;
-                    LOGINFO("instances: %04d (%04d extant + %04d pending + %04d terminated)\n", (num_pending + num_extant + num_teardown), num_extant, num_pending, num_teardown);
-                    LOGINFO("    nodes: %04d (%04d busy + %04d idle + %04d unresponsive)\n", (res_busy + res_idle + res_bad), res_busy, res_idle, res_bad);
-                }
-            }
-
-            if (ncSensorsRefresh) {
-                rc = refresh_sensors(&pMeta, 60, 1);
-                if (rc == 0) {
-                    // refresh_sensors() only returns non-zero when sensor subsystem has not been initialized.
-                    // Until it is initialized, keep checking every second, so that sensory subsystems on NCs are
-                    // initialized soon after it is initialized on the CC (otherwise it may take a while and NC
-                    // may miss initial measurements from early instances). Once initialized, refresh can happen
-                    // as configured by config->ncSensorsPollingInterval.
-                    ncSensorsRefresh = 0;
-                }
-            }
+    // the arbitrators are checked on the first loop iteration
+    clcTimer = 1;
 
-            if (ncRefresh) {
-                if (is_clean_instanceCache()) {
-                    // Network state operations
-                    //  sem_mywait(RESCACHE);
+    // all the tasks run upon the first loop iteration with the CC enabled
+    for (i = 0; i < MONITOR_TASK_LAST; i++) {
+        config->monitorTasks[i].nextRun = 0;
+    }
 
-                    LOGDEBUG("syncing network state\n");
-                    rc = syncNetworkState();
-                    if (rc) {
-                        LOGDEBUG("syncNetworkState() triggering network restore\n");
-                        config->kick_network = 1;
-                    }
-                    //    sem_mypost(RESCACHE);
+    while (1) {
+        LOGTRACE("running\n");
 
-                    if (config->kick_network) {
-                        LOGDEBUG("restoring network state\n");
-                        rc = restoreNetworkState();
-                        if (rc) {
-                            // failed to restore network state, continue
-                            LOGWARN("restoreNetworkState returned false (may be already restored)\n");
-                        } else {
-                            sem_mywait(CONFIG);
-                            config->kick_network = 0;
-                            sem_mypost(CONFIG);
-                        }
-                    }
-                } else {
-                    LOGDEBUG("instanceCache is dirty, skipping network update\n");
-                }
+        if (config->kick_enabled) {
+            ccChangeState(ENABLED);
+            config->kick_enabled = 0;
+            enabled_ms = mono_time_ms();
+            for (i = 0; i < MONITOR_TASK_LAST; i++) {
+                config->monitorTasks[i].nextRun = 0;
             }
+        }
 
-            if (clcRefresh) {
-                LOGDEBUG("syncing CLC network rules ground truth with local state\n");
-                rc = reconfigureNetworkFromCLC();
-                if (rc) {
-                    LOGWARN("cannot get network ground truth from CLC\n");
-                }
-            }
+        rc = update_config();
+        if (rc) {
+            LOGWARN("bad return from update_config(), check your config file\n");
+        }
 
-            if (ncRefresh) {
-                LOGDEBUG("maintaining network state\n");
-                rc = maintainNetworkState();
-                if (rc) {
-                    LOGERROR("network state maintainance failed\n");
+        now_ms = mono_time_ms();
+        for (i = 0; i < MONITOR_TASK_LAST; i++) {
+            monitor_task_start(i, &pMeta);
+
+            task = &(config->monitorTasks[i]);
+            if (task->running) {
+                if (!overrun[i] && (((now_ms - task->lastStart) / 1000) > monitorTasks[i].deadline)) {
+                    LOGWARN("monitor task %s has been running for %lds, past its %lds deadline\n", monitorTasks[i].name, (long)((now_ms - task->lastStart) / 1000),
+                            (long)monitorTasks[i].deadline);
+                    overrun[i] = TRUE;
                 }
+            } else {
+                overrun[i] = FALSE;
             }
+        }
 
-            if (config->use_proxy) {
-                rc = image_cache_invalidate();
-                if (rc) {
-                    LOGERROR("cannot invalidate image cache\n");
-                }
-                snprintf(pidfile, EUCA_MAX_PATH, EUCALYPTUS_RUN_DIR "/httpd-dynserv.pid", config->eucahome);
-                pidstr = file2str(pidfile);
-                if (pidstr) {
-                    if (check_process(atoi(pidstr), "dynserv-httpd.conf")) {
-                        rc = image_cache_proxykick(resourceCache->resources, &(resourceCache->numResources));
-                        if (rc) {
-                            LOGERROR("could not start proxy cache\n");
-                        }
-                    }
-                    EUCA_FREE(pidstr);
-                } else {
-                    rc = image_cache_proxykick(resourceCache->resources, &(resourceCache->numResources));
-                    if (rc) {
-                        LOGERROR("could not start proxy cache\n");
-                    }
-                }
+        if (config->ccState == ENABLED) {
+            // the CC is back once the caches have been refreshed since it was enabled
+            if (!config->kick_monitor_running && (config->monitorTasks[MONITOR_TASK_RESOURCES].lastEnd >= enabled_ms)
+                && (config->monitorTasks[MONITOR_TASK_INSTANCES].lastEnd >= enabled_ms)) {
+                config->kick_monitor_running = 1;
             }
-            config->kick_monitor_running = 1;
         } else {
             // this CC is not enabled, ensure that local network state is disabled
             rc = clean_network_state();
@@ -6108,11 +8399,14 @@ void *monitor_thread(void *in)
             ccChangeState(DISABLED);
         }
         sem_mypost(CONFIG);
+
+        if (++clcTimer > config->clcPollingFrequency)
+            clcTimer = 1;
+
+        // the children of this process are the task workers, the workers reap their own
         shawn();
 
         LOGTRACE("localState=%s - done.\n", config->ccStatus.localState);
-        //sleep(config->ncPollingFrequency);
-        ncRefresh = clcRefresh = 0;
         sleep(1);
     }
 
@@ -6153,7 +8447,7 @@ int init_pthreads(void)
                 sigaction(SIGTERM, &newsigact, NULL);
                 LOGDEBUG("sensor polling process running\n");
                 LOGDEBUG("calling sensor_init() to not return.\n");
-                if (sensor_init(s, ccSensorResourceCache, MAX_SENSOR_RESOURCES, TRUE, update_config) != EUCA_OK)    // this call will not return
+                if (sensor_init(s, ccSensorResourceCache, sharedBufferOpts.maxSensorResources, TRUE, update_config) != EUCA_OK)    // this call will not return
                     LOGERROR("failed to invoke the sensor polling process\n");
                 exit(0);
             } else {
@@ -6161,7 +8455,7 @@ int init_pthreads(void)
             }
         }
         LOGDEBUG("calling sensor_init(..., NULL) to return.\n");
-        if (sensor_init(s, ccSensorResourceCache, MAX_SENSOR_RESOURCES, FALSE, NULL) != EUCA_OK) {  // this call will return
+        if (sensor_init(s, ccSensorResourceCache, sharedBufferOpts.maxSensorResources, FALSE, NULL) != EUCA_OK) {  // this call will return
             LOGERROR("failed to initialize sensor subsystem in this process\n");
         } else {
             LOGDEBUG("sensor subsystem initialized in this process\n");
@@ -6279,6 +8573,12 @@ int init_log(void)
             }
             EUCA_FREE(log_facility);
         }
+
+        char *log_async = configFileValue("LOGASYNC");
+        if (log_async) {
+            euca_strncpy(config->log_async, log_async, sizeof(config->log_async));
+            EUCA_FREE(log_async);
+        }
         // set the log file path (levels and size limits are set below)
         log_file_set(logFile, logFileReqTrack);
 
@@ -6289,6 +8589,7 @@ int init_log(void)
     log_params_set(config->log_level, (int)config->log_roll_number, config->log_max_size_bytes);
     log_prefix_set(config->log_prefix);
     log_facility_set(config->log_facility, "cc");
+    log_async_set(config->log_async);
 
     return (0);
 }
@@ -6320,6 +8621,8 @@ int init_thread(void)
         locks[INIT] = sem_open("/eucalyptusCCinitLock", O_CREAT, 0644, 1);
         sem_mywait(INIT);
 
+        read_shared_buffer_options();
+
         for (i = NCCALL0; i <= NCCALL31; i++) {
             char lockname[EUCA_MAX_PATH];
             snprintf(lockname, EUCA_MAX_PATH, "/eucalyptusCCncCallLock%d", i);
@@ -6343,6 +8646,12 @@ int init_thread(void)
                 sem_mypost(INIT);
                 exit(1);
             }
+
+            sem_mywait(INSTCACHE);
+            if (!instanceCache->indexed) {
+                rebuild_instanceCacheIndex();
+            }
+            sem_mypost(INSTCACHE);
         }
 
         if (resourceCache == NULL) {
@@ -6367,13 +8676,20 @@ int init_thread(void)
 
         if (ccSensorResourceCache == NULL) {
             rc = setup_shared_buffer((void **)&ccSensorResourceCache, "/eucalyptusCCSensorResourceCache",
-                                     sizeof(sensorResourceCache) + sizeof(sensorResource) * (MAX_SENSOR_RESOURCES - 1), &(locks[SENSORCACHE]),
+                                     SENSOR_CACHE_SIZE(sharedBufferOpts.maxSensorResources), &(locks[SENSORCACHE]),
                                      "/eucalyptusCCSensorResourceCacheLock", SHARED_FILE);
             if (rc != 0) {
                 fprintf(stderr, "Cannot set up shared memory region for ccSensorResourceCache, exiting...\n");
                 sem_mypost(INIT);
                 exit(1);
             }
+
+            // a cache left over from a different size must be set up again by the sensor subsystem
+            sem_wait(locks[SENSORCACHE]);
+            if (ccSensorResourceCache->initialized && (ccSensorResourceCache->max_resources != sharedBufferOpts.maxSensorResources)) {
+                bzero(ccSensorResourceCache, SENSOR_CACHE_SIZE(sharedBufferOpts.maxSensorResources));
+            }
+            sem_post(locks[SENSORCACHE]);
         }
 
         if (vnetconfig == NULL) {
@@ -6397,7 +8713,7 @@ int init_thread(void)
        
         //setup message stats shared buffer
         if (message_stats_shared_mem == NULL) {
-            rc = setup_shared_buffer((void **)&message_stats_shared_mem, "/eucalyptusCCmessageStats", MESSAGE_STATS_MEMORY_REGION_SIZE, &(locks[STATSCACHE]),
+            rc = setup_shared_buffer((void **)&message_stats_shared_mem, "/eucalyptusCCmessageStats", sizeof(message_stats_state), &(locks[STATSCACHE]),
                                      "/eucalyptusCCmessageStatsLock", SHARED_FILE);
             if(rc != 0) {
                 fprintf(stderr, "Cannot setup shared memory region for message statistics, exiting...\n");
@@ -6406,6 +8722,17 @@ int init_thread(void)
             }
        }
 
+        if (trace_ring_shared_mem == NULL) {
+            rc = setup_shared_buffer((void **)&trace_ring_shared_mem, "/eucalyptusCCtraceRing", sizeof(trace_ring), &(locks[TRACERING]), "/eucalyptusCCtraceRingLock",
+                                     SHARED_FILE);
+            if (rc != 0) {
+                fprintf(stderr, "Cannot set up shared memory region for tracing spans, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+            trace_init(trace_ring_shared_mem);
+        }
+
         sem_mypost(INIT);
         thread_init = 1;
     }
@@ -6413,64 +8740,57 @@ int init_thread(void)
 }
 
 
-//! Update the message stat structure
-//! Wraps the message stats update with the necessary caching copies.
-//! Caller must handle necessary locks
-static json_object **message_stats_getter()
+//! Gets the message stats, which live in the memory region shared by all CC processes.
+//! The counters are updated atomically, so no lock is needed.
+static message_stats_state *message_stats_getter()
 {
-    LOGTRACE("Fetching latest message stats from shared memory\n");
-    
-    //copy the memory region into the proc-local buffer from the shared-memory region
-    euca_strncpy(message_stats_cache, message_stats_shared_mem, MESSAGE_STATS_MEMORY_REGION_SIZE);
-
-    //A process-local json cache to avoid repeated parsing
-    stats_cache_json = json_tokener_parse(message_stats_cache);
-    
-    LOGTRACE("Message stats fetch complete\n");
-    return &stats_cache_json;
+    return message_stats_shared_mem;
 }
 
-//! Write the cached value back to the shared memory region
-//! Must be called from within a lock for the memory region
-static void message_stats_setter()
+//! Update the message stat structure. Lock-free, the counters are updated in place
+//! in the shared memory region
+int cached_message_stats_update(const char *message_name, long call_time, int msg_failed)
 {
-    LOGTRACE("Updating latest message stats from shared memory\n");
-
-    if(stats_cache_json != NULL) {
-        //Write the memory back
-        const char *output = json_object_to_json_string(stats_cache_json);
-        LOGTRACE("Setting stats state to: %s\n", output);
-
-        if(strlen(output) + 1 > MESSAGE_STATS_MEMORY_REGION_SIZE) {
-            LOGERROR("Pre-allocated size for internal message stats exceeded. Stats updates will not be reflected.\n");
-        } else {
-            euca_strncpy(message_stats_shared_mem, output, strlen(output) + 1);
-        }
-        
-        json_object_put(stats_cache_json); //Free it
-    } 
-           
-    LOGTRACE("Message stats fetch complete\n");
-    return;
+    LOGTRACE("Updating message stats for message %s\n", message_name);
+    return update_message_stats(message_stats_getter(), message_name, call_time, msg_failed);
 }
 
-//! Update the message stat structure
-//! Wraps the message stats update with the necessary caching copies and locking
-int cached_message_stats_update(const char *message_name, long call_time, int msg_failed)
+//!
+//! Reads the bounds of the adaptive polling of the nodes, NC_POLLING_MIN and NC_POLLING_MAX.
+//! Either one defaults to NC_POLLING_FREQUENCY, so that the nodes are polled at that fixed
+//! interval unless the bounds are set. The longest interval stays under half of the instance
+//! timeout, or the instances of stable nodes would be dropped from the cache between polls.
+//!
+//! @param[in]  frequency the NC_POLLING_FREQUENCY
+//! @param[in]  instanceTimeout the INSTANCE_TIMEOUT
+//! @param[out] pMin the shortest interval between polls of a node
+//! @param[out] pMax the longest interval between polls of a node
+//!
+static void nc_polling_bounds(time_t frequency, time_t instanceTimeout, time_t * pMin, time_t * pMax)
 {
-    LOGTRACE("Updating message stats for message %s\n", message_name);
-    lock_stats();
-    
-    json_object **stats_state = message_stats_getter();
+    char *tmpstr = NULL;
 
-    //Update the counters
-    update_message_stats(*stats_state, message_name, call_time, msg_failed);
+    *pMin = *pMax = frequency;
+    if ((tmpstr = configFileValue("NC_POLLING_MIN")) != NULL) {
+        *pMin = atoi(tmpstr);
+        if ((*pMin < 1) || (*pMin > frequency)) {
+            LOGWARN("NC_POLLING_MIN out of range (%s seconds), resetting to NC_POLLING_FREQUENCY (%ld seconds)\n", tmpstr, (long)frequency);
+            *pMin = frequency;
+        }
+        EUCA_FREE(tmpstr);
+    }
 
-    message_stats_setter();
-    
-    unlock_stats();
-    LOGTRACE("Message stats update complete\n");
-    return EUCA_OK;
+    if ((tmpstr = configFileValue("NC_POLLING_MAX")) != NULL) {
+        *pMax = atoi(tmpstr);
+        if (*pMax < frequency) {
+            LOGWARN("NC_POLLING_MAX out of range (%s seconds), resetting to NC_POLLING_FREQUENCY (%ld seconds)\n", tmpstr, (long)frequency);
+            *pMax = frequency;
+        } else if (*pMax > MAX((instanceTimeout / 2), frequency)) {
+            *pMax = MAX((instanceTimeout / 2), frequency);
+            LOGWARN("NC_POLLING_MAX set too high (%s seconds), resetting to %ld seconds for an INSTANCE_TIMEOUT of %ld seconds\n", tmpstr, (long)(*pMax), (long)instanceTimeout);
+        }
+        EUCA_FREE(tmpstr);
+    }
 }
 
 
@@ -6516,10 +8836,17 @@ int update_config(void)
                 }
                 EUCA_FREE(log_facility);
             }
+
+            char *log_async = configFileValue("LOGASYNC");
+            if (log_async) {
+                euca_strncpy(config->log_async, log_async, sizeof(config->log_async));
+                EUCA_FREE(log_async);
+            }
             // reconfigure the logging subsystem to use the new values, if any
             log_params_set(config->log_level, (int)config->log_roll_number, config->log_max_size_bytes);
             log_prefix_set(config->log_prefix);
             log_facility_set(config->log_facility, "cc");
+            log_async_set(config->log_async);
 
             // NODES
             LOGINFO("refreshing node list\n");
@@ -6571,6 +8898,7 @@ int update_config(void)
             } else {
                 config->ncPollingFrequency = 6;
             }
+            nc_polling_bounds(config->ncPollingFrequency, config->instanceTimeout, &(config->ncPollingMin), &(config->ncPollingMax));
 
             // enabled sensors list -- removed since it is part of sensor cycle
             //update_sensors_list();
@@ -6595,12 +8923,14 @@ int init_config(void)
 {
     ccResource *res = NULL;
     char *tmpstr = NULL, *proxyIp = NULL;
-    int rc, numHosts, use_wssec, use_tunnels, use_proxy, proxy_max_cache_size, schedPolicy, idleThresh, wakeThresh, i;
+    int rc, numHosts, use_wssec, use_ncpool, use_checkpoint, use_tunnels, use_proxy, proxy_max_cache_size, schedPolicy, idleThresh, wakeThresh, consolidateThresh, i;
+    int migrationMaxPerSource, migrationMaxPerDest;
 
     char configFiles[2][EUCA_MAX_PATH], netPath[EUCA_MAX_PATH], eucahome[EUCA_MAX_PATH], policyFile[EUCA_MAX_PATH], home[EUCA_MAX_PATH], proxyPath[EUCA_MAX_PATH], arbitrators[256],
         schedPath[EUCA_MAX_PATH];
 
-    time_t instanceTimeout, ncPollingFrequency, clcPollingFrequency, ncFanout;
+    time_t instanceTimeout, ncPollingFrequency, ncPollingMin, ncPollingMax, clcPollingFrequency, ncFanout;
+    int eventPort;
 
     // read in base config information
     tmpstr = getenv(EUCALYPTUS_ENV_VAR_NAME);
@@ -6651,7 +8981,7 @@ int init_config(void)
             *pubips = NULL,
             *pubInterface = NULL,
             *privInterface = NULL, *pubSubnet = NULL, *pubSubnetMask = NULL, *pubBroadcastAddress = NULL, *pubRouter = NULL, *pubDomainname =
-            NULL, *pubDNS = NULL, *localIp = NULL, *macPrefix = NULL;
+            NULL, *pubDNS = NULL, *localIp = NULL, *macPrefix = NULL, *tunnelMode = NULL;
 
         uint32_t *ips, *nms;
         int initFail = 0, len, usednew = 0;;
@@ -6779,6 +9109,7 @@ int init_config(void)
             pubDomainname = configFileValue("VNET_DOMAINNAME");
             pubips = configFileValue("VNET_PUBLICIPS");
             localIp = configFileValue("VNET_LOCALIP");
+            tunnelMode = configFileValue("VNET_TUNNEL_MODE");
             if (!localIp) {
                 LOGWARN("VNET_LOCALIP not defined, will attempt to auto-discover (consider setting this explicitly if tunnelling does not function " "properly.)\n");
             }
@@ -6801,6 +9132,7 @@ int init_config(void)
             EUCA_FREE(numaddrs);
             EUCA_FREE(pubips);
             EUCA_FREE(localIp);
+            EUCA_FREE(tunnelMode);
             EUCA_FREE(pubInterface);
             EUCA_FREE(privInterface);
             EUCA_FREE(dhcpuser);
@@ -6835,9 +9167,13 @@ int init_config(void)
             sem_mypost(VNET);
             sem_mypost(INIT);
             EUCA_FREE(pubips);
+            EUCA_FREE(tunnelMode);
             return (1);
         }
 
+        vnetSetTunnelMode(vnetconfig, tunnelMode);
+        EUCA_FREE(tunnelMode);
+
         vnetAddDev(vnetconfig, vnetconfig->privInterface);
 
         if (pubmacmap) {
@@ -6921,6 +9257,10 @@ int init_config(void)
             schedPolicy = SCHEDROUNDROBIN;
         else if (!strcmp(tmpstr, "POWERSAVE"))
             schedPolicy = SCHEDPOWERSAVE;
+        else if (!strcmp(tmpstr, "BINPACK"))
+            schedPolicy = SCHEDBINPACK;
+        else if (!strcmp(tmpstr, "SPREAD"))
+            schedPolicy = SCHEDSPREAD;
         else if (access(tmpstr, X_OK) == 0) {   // scheduler is an executable path, assumed to be user scheduler
             LOGWARN("will use user-defined scheduler at '%s'\n", tmpstr);
             euca_strncpy(schedPath, tmpstr, sizeof(schedPath));
@@ -6961,6 +9301,19 @@ int init_config(void)
     }
     EUCA_FREE(tmpstr);
 
+    tmpstr = configFileValue("POWER_CONSOLIDATETHRESH");
+    if (!tmpstr) {
+        consolidateThresh = 0;
+        tmpstr = NULL;
+    } else {
+        consolidateThresh = atoi(tmpstr);
+        if ((consolidateThresh < 0) || (consolidateThresh > 100)) {
+            LOGWARN("POWER_CONSOLIDATETHRESH out of range (%d percent), disabling consolidation\n", consolidateThresh);
+            consolidateThresh = 0;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
     // some administrative options
     tmpstr = configFileValue("NC_POLLING_FREQUENCY");
     if (!tmpstr) {
@@ -6975,6 +9328,11 @@ int init_config(void)
     }
     EUCA_FREE(tmpstr);
 
+    // NCs announce instance changes over UDP to the port the CC serves on
+    tmpstr = configFileValue("CC_PORT");
+    eventPort = (tmpstr ? atoi(tmpstr) : 8774);
+    EUCA_FREE(tmpstr);
+
     tmpstr = configFileValue("CLC_POLLING_FREQUENCY");
     if (!tmpstr) {
         clcPollingFrequency = 6;
@@ -6997,15 +9355,43 @@ int init_config(void)
         bzero(arbitrators, 256);
     }
 
+    // NC_FANOUT caps the number of NCs polled concurrently, 0 means all of them at once
     tmpstr = configFileValue("NC_FANOUT");
     if (!tmpstr) {
-        ncFanout = 1;
+        ncFanout = 0;
         tmpstr = NULL;
     } else {
         ncFanout = atoi(tmpstr);
-        if (ncFanout < 1 || ncFanout > 32) {
-            LOGWARN("NC_FANOUT set out of bounds (min=%d max=%d) (current=%ld), resetting to default (1 NC)\n", 1, 32, ncFanout);
-            ncFanout = 1;
+        if (ncFanout < 0 || ncFanout > MAXNODES) {
+            LOGWARN("NC_FANOUT set out of bounds (min=%d max=%d) (current=%ld), resetting to default (all NCs)\n", 0, MAXNODES, ncFanout);
+            ncFanout = 0;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    // how many migrations of an evacuation may run at once out of each node and into each node
+    tmpstr = configFileValue("CC_MIGRATION_MAX_PER_SOURCE");
+    if (!tmpstr) {
+        migrationMaxPerSource = 2;
+        tmpstr = NULL;
+    } else {
+        migrationMaxPerSource = atoi(tmpstr);
+        if (migrationMaxPerSource < 0) {
+            LOGWARN("CC_MIGRATION_MAX_PER_SOURCE set too low (%d), resetting to default (2)\n", migrationMaxPerSource);
+            migrationMaxPerSource = 2;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    tmpstr = configFileValue("CC_MIGRATION_MAX_PER_DEST");
+    if (!tmpstr) {
+        migrationMaxPerDest = 2;
+        tmpstr = NULL;
+    } else {
+        migrationMaxPerDest = atoi(tmpstr);
+        if (migrationMaxPerDest < 0) {
+            LOGWARN("CC_MIGRATION_MAX_PER_DEST set too low (%d), resetting to default (2)\n", migrationMaxPerDest);
+            migrationMaxPerDest = 2;
         }
     }
     EUCA_FREE(tmpstr);
@@ -7022,6 +9408,7 @@ int init_config(void)
         }
     }
     EUCA_FREE(tmpstr);
+    nc_polling_bounds(ncPollingFrequency, instanceTimeout, &ncPollingMin, &ncPollingMax);
 
     // WS-Security
     use_wssec = 0;
@@ -7038,6 +9425,26 @@ int init_config(void)
     }
     EUCA_FREE(tmpstr);
 
+    // Persistent NC connections
+    use_ncpool = 0;
+    tmpstr = configFileValue("NC_CONNECTION_POOL");
+    if (tmpstr) {
+        if (!strcmp(tmpstr, "Y")) {
+            use_ncpool = 1;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
+    // Cache checkpoint for fast restarts
+    use_checkpoint = 0;
+    tmpstr = configFileValue("CC_CHECKPOINT");
+    if (tmpstr) {
+        if (!strcmp(tmpstr, "Y")) {
+            use_checkpoint = 1;
+        }
+    }
+    EUCA_FREE(tmpstr);
+
     // Multi-cluster tunneling
     use_tunnels = 1;
     tmpstr = configFileValue("DISABLE_TUNNELING");
@@ -7098,17 +9505,24 @@ int init_config(void)
     EUCA_FREE(proxyIp);
 
     config->use_wssec = use_wssec;
+    config->use_ncpool = use_ncpool;
+    config->use_checkpoint = use_checkpoint;
     config->use_tunnels = use_tunnels;
     config->schedPolicy = schedPolicy;
     euca_strncpy(config->schedPath, schedPath, sizeof(config->schedPath));
     config->idleThresh = idleThresh;
     config->wakeThresh = wakeThresh;
+    config->consolidateThresh = consolidateThresh;
     config->instanceTimeout = instanceTimeout;
     config->ncPollingFrequency = ncPollingFrequency;
+    config->ncPollingMin = ncPollingMin;
+    config->ncPollingMax = ncPollingMax;
+    config->eventPort = eventPort;
     config->ncSensorsPollingInterval = ncPollingFrequency;  // initially poll sensors with the same frequency as other NC ops
     config->clcPollingFrequency = clcPollingFrequency;
     config->ncFanout = ncFanout;
-    locks[REFRESHLOCK] = sem_open("/eucalyptusCCrefreshLock", O_CREAT, 0644, config->ncFanout);
+    config->migrationMaxPerSource = migrationMaxPerSource;
+    config->migrationMaxPerDest = migrationMaxPerDest;
     config->initialized = 1;
     ccChangeState(LOADED);
     config->ccStatus.localEpoch = 0;
@@ -7135,11 +9549,25 @@ int init_config(void)
     LOGINFO("   CC Configuration: eucahome=%s\n", SP(config->eucahome));
     LOGINFO("                     policyfile=%s\n", SP(config->policyFile));
     LOGINFO("                     ws-security=%s\n", use_wssec ? "ENABLED" : "DISABLED");
+    LOGINFO("                     nc-connection-pool=%s\n", use_ncpool ? "ENABLED" : "DISABLED");
+    LOGINFO("                     cache-checkpoint=%s\n", use_checkpoint ? "ENABLED" : "DISABLED");
+    LOGINFO("                     shared-segments=%s%s max-sensor-resources=%d\n", (sharedBufferOpts.hugepageDir[0] ? sharedBufferOpts.hugepageDir : "state directory"),
+            (sharedBufferOpts.prefault ? " (prefaulted)" : ""), sharedBufferOpts.maxSensorResources);
+    LOGINFO("                     nc-fanout=%d%s\n", config->ncFanout, config->ncFanout ? "" : " (all NCs)");
     LOGINFO("                     schedulerPolicy=%s\n", SP(SCHEDPOLICIES[config->schedPolicy]));
     LOGINFO("                     idleThreshold=%d\n", config->idleThresh);
     LOGINFO("                     wakeThreshold=%d\n", config->wakeThresh);
+    LOGINFO("                     consolidateThreshold=%d%%\n", config->consolidateThresh);
+    LOGINFO("                     migrations per source=%d per destination=%d\n", config->migrationMaxPerSource, config->migrationMaxPerDest);
     sem_mypost(CONFIG);
 
+    // start from the caches as they were when the CC went down, the monitor then catches up with the NCs
+    if (checkpoint_restore() == EUCA_OK) {
+        sem_mywait(INSTCACHE);
+        rebuild_instanceCacheIndex();
+        sem_mypost(INSTCACHE);
+    }
+
     res = NULL;
     rc = refreshNodes(config, &res, &numHosts);
     if (rc) {
@@ -7201,18 +9629,26 @@ int checkActiveNetworks(void)
         bzero(activeNetworks, sizeof(int) * NUMBER_OF_VLANS);
 
         LOGDEBUG("checkActiveNetworks(): maintaining active networks\n");
-        for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
-            if (instanceCache->cacheState[i] != INSTINVALID) {
-                if (strcmp(instanceCache->instances[i].state, "Teardown")) {
-                    int vlan = instanceCache->instances[i].ccnet.vlan;
-                    activeNetworks[vlan] = 1;
-                    if (!vnetconfig->networks[vlan].active) {
-                        LOGWARN("checkActiveNetworks(): instance running in network that is currently inactive (%s, %s, %d)\n",
-                                vnetconfig->users[vlan].userName, vnetconfig->users[vlan].netName, vlan);
-                    }
+        sem_mywait(INSTCACHE);
+        for (i = 0; i < NUMBER_OF_VLANS; i++) {
+            int slot = 0;
+
+            // the VLAN index has the instances of each network, only one of them needs to still be up
+            if (!instanceCache->groupHead[INSTGRP_VLAN][i])
+                continue;
+            for (slot = instanceCacheGroupNext(INSTGRP_VLAN, NULL, i, -1); slot >= 0; slot = instanceCacheGroupNext(INSTGRP_VLAN, NULL, i, slot)) {
+                if (strcmp(instanceCache->summaries[slot].state, "Teardown"))
+                    break;
+            }
+            if (slot >= 0) {
+                activeNetworks[i] = 1;
+                if (!vnetconfig->networks[i].active) {
+                    LOGWARN("checkActiveNetworks(): instance running in network that is currently inactive (%s, %s, %d)\n",
+                            vnetconfig->users[i].userName, vnetconfig->users[i].netName, i);
                 }
             }
         }
+        sem_mypost(INSTCACHE);
 
         for (i = 0; i < NUMBER_OF_VLANS; i++) {
             sem_mywait(VNET);
@@ -7453,11 +9889,17 @@ int restoreNetworkState(void)
 
     if (!strcmp(vnetconfig->mode, NETMODE_MANAGED) || !strcmp(vnetconfig->mode, NETMODE_MANAGED_NOVLAN) || !strcmp(vnetconfig->mode, NETMODE_EDGE)
         || !strcmp(vnetconfig->mode, NETMODE_VPCMIDO)) {
+        // in MANAGED modes, all the addresses and their rules go in at once
+        boolean batched = (vnetAssignBatchBegin(vnetconfig) == EUCA_OK);
         rc = map_instanceCache(validCmp, NULL, instNetReassignAddrs, NULL);
         if (rc) {
             LOGERROR("could not (re)assign public/private IP mappings\n");
             ret = 1;
         }
+        if (batched && (vnetAssignBatchCommit(vnetconfig) != EUCA_OK)) {
+            LOGERROR("could not apply the batch of public/private IP mappings\n");
+            ret = 1;
+        }
     }
 
     if (strcmp(vnetconfig->mode, NETMODE_EDGE) && strcmp(vnetconfig->mode, NETMODE_VPCMIDO)) {
@@ -7905,7 +10347,7 @@ int free_instanceNetwork(char *mac, int vlan, int force, int dolock)
     if (!force) {
         // check to make sure the mac isn't in use elsewhere
         for (i = 0; ((i < MAXINSTANCES_PER_CC) && !inuse); i++) {
-            if (!strcmp(instanceCache->instances[i].ccnet.privateMac, mac) && strcmp(instanceCache->instances[i].state, "Teardown")) {
+            if (!strcmp(instanceCache->summaries[i].privateMac, mac) && strcmp(instanceCache->summaries[i].state, "Teardown")) {
                 inuse = TRUE;
             }
         }
@@ -8143,6 +10585,370 @@ int pubIpSet(ccInstance * inst, void *ip)
     return (0);
 }
 
+//!
+//! Returns the key a cached instance is indexed under in the given lookup index
+//!
+//! @param[in] idx the lookup index (INSTIDX_ID, INSTIDX_PUBLICIP or INSTIDX_PRIVATEIP)
+//! @param[in] inst a pointer to the summary of the cached instance
+//!
+//! @return the key or NULL if the instance should not be present in this index
+//!
+//! @note Unassigned addresses ("0.0.0.0") are shared by many instances and are not indexed
+//!
+static char *instanceCacheIndexKey(int idx, ccInstanceSummary * inst)
+{
+    char *key = NULL;
+
+    switch (idx) {
+    case INSTIDX_ID:
+        key = inst->instanceId;
+        break;
+    case INSTIDX_PUBLICIP:
+        key = inst->publicIp;
+        break;
+    case INSTIDX_PRIVATEIP:
+        key = inst->privateIp;
+        break;
+    default:
+        return (NULL);
+    }
+
+    if ((key[0] == '\0') || ((idx != INSTIDX_ID) && !strcmp(key, "0.0.0.0")))
+        return (NULL);
+    return (key);
+}
+
+//!
+//! Computes the home bucket of a key in an instance cache lookup index
+//!
+//! @param[in] key the key to hash
+//!
+//! @return the bucket number
+//!
+static int instanceCacheIndexBucket(const char *key)
+{
+    return ((int)(jenkins(key, strlen(key)) & (INSTANCE_INDEX_SIZE - 1)));
+}
+
+//!
+//! Adds a cache slot to the given lookup index (open addressing, linear probing)
+//!
+//! @param[in] idx the lookup index
+//! @param[in] slot the instance cache slot
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void instanceCacheIndexInsert(int idx, int slot)
+{
+    int i = 0;
+    int *table = instanceCache->index[idx];
+    char *key = NULL;
+
+    if ((key = instanceCacheIndexKey(idx, &(instanceCache->summaries[slot]))) == NULL)
+        return;
+
+    for (i = instanceCacheIndexBucket(key); table[i] != 0; i = ((i + 1) & (INSTANCE_INDEX_SIZE - 1))) {
+        if (table[i] == (slot + 1))
+            return;
+    }
+    table[i] = (slot + 1);
+}
+
+//!
+//! Removes a cache slot from the given lookup index. The following entries of the probe
+//! run are shifted back so lookups never need tombstones.
+//!
+//! @param[in] idx the lookup index
+//! @param[in] slot the instance cache slot
+//!
+//! @note this should be called with INSTCACHE lock held and before the slot content changes
+//!
+static void instanceCacheIndexRemove(int idx, int slot)
+{
+    int i = 0;
+    int j = 0;
+    int home = 0;
+    int *table = instanceCache->index[idx];
+    char *key = NULL;
+
+    if ((key = instanceCacheIndexKey(idx, &(instanceCache->summaries[slot]))) == NULL)
+        return;
+
+    for (i = instanceCacheIndexBucket(key); table[i] != (slot + 1); i = ((i + 1) & (INSTANCE_INDEX_SIZE - 1))) {
+        if (table[i] == 0)
+            return;
+    }
+
+    table[i] = 0;
+    for (j = ((i + 1) & (INSTANCE_INDEX_SIZE - 1)); table[j] != 0; j = ((j + 1) & (INSTANCE_INDEX_SIZE - 1))) {
+        key = instanceCacheIndexKey(idx, &(instanceCache->summaries[table[j] - 1]));
+        home = (key) ? instanceCacheIndexBucket(key) : j;
+        // leave the entry where it is if its home bucket lies cyclically in (i, j]
+        if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j)))
+            continue;
+        table[i] = table[j];
+        table[j] = 0;
+        i = j;
+    }
+}
+
+//!
+//! Looks up a valid cache slot by key in the given lookup index
+//!
+//! @param[in] idx the lookup index
+//! @param[in] key the instance ID or IP address to look for
+//!
+//! @return the instance cache slot or -1 if not found
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static int instanceCacheIndexFind(int idx, const char *key)
+{
+    int i = 0;
+    int slot = 0;
+    int *table = instanceCache->index[idx];
+    char *slotkey = NULL;
+
+    if (!key || (key[0] == '\0'))
+        return (-1);
+
+    for (i = instanceCacheIndexBucket(key); table[i] != 0; i = ((i + 1) & (INSTANCE_INDEX_SIZE - 1))) {
+        slot = table[i] - 1;
+        if (instanceCache->cacheState[slot] == INSTVALID) {
+            if (((slotkey = instanceCacheIndexKey(idx, &(instanceCache->summaries[slot]))) != NULL) && !strcmp(slotkey, key))
+                return (slot);
+        }
+    }
+    return (-1);
+}
+
+//!
+//! Computes the chain of a key in an instance cache secondary index
+//!
+//! @param[in] grp  the secondary index (INSTGRP_*)
+//! @param[in] skey the owner ID, for INSTGRP_OWNER
+//! @param[in] ikey the VLAN or node index, for INSTGRP_VLAN and INSTGRP_NODE
+//!
+//! @return the chain number or -1 if the key is not indexed
+//!
+static int instanceCacheGroupChain(int grp, const char *skey, int ikey)
+{
+    switch (grp) {
+    case INSTGRP_OWNER:
+        if (!skey || (skey[0] == '\0'))
+            return (-1);
+        return ((int)(jenkins(skey, strlen(skey)) & (INSTANCE_GROUP_CHAINS - 1)));
+    case INSTGRP_VLAN:
+    case INSTGRP_NODE:
+        if ((ikey < 0) || (ikey >= INSTANCE_GROUP_CHAINS))
+            return (-1);
+        return (ikey);
+    default:
+        break;
+    }
+    return (-1);
+}
+
+//!
+//! Tells whether a cache slot has the given key in a secondary index. Chains are shared
+//! by the owner IDs that hash alike, so their walks check every slot.
+//!
+//! @param[in] grp  the secondary index (INSTGRP_*)
+//! @param[in] slot the instance cache slot
+//! @param[in] skey the owner ID, for INSTGRP_OWNER
+//! @param[in] ikey the VLAN or node index, for INSTGRP_VLAN and INSTGRP_NODE
+//!
+//! @return TRUE if the slot has this key, FALSE otherwise
+//!
+static boolean instanceCacheGroupMatch(int grp, int slot, const char *skey, int ikey)
+{
+    ccInstance *inst = &(instanceCache->instances[slot]);
+
+    switch (grp) {
+    case INSTGRP_OWNER:
+        return ((skey && !strcmp(inst->ownerId, skey)) ? TRUE : FALSE);
+    case INSTGRP_VLAN:
+        return ((instanceCache->summaries[slot].vlan == ikey) ? TRUE : FALSE);
+    case INSTGRP_NODE:
+        return ((instanceCache->summaries[slot].ncHostIdx == ikey) ? TRUE : FALSE);
+    default:
+        break;
+    }
+    return (FALSE);
+}
+
+//!
+//! Links a cache slot at the head of its chain in the given secondary index
+//!
+//! @param[in] grp  the secondary index
+//! @param[in] slot the instance cache slot
+//!
+//! @note this should be called with INSTCACHE lock held, once the summary of the slot is up to date
+//!
+static void instanceCacheGroupLink(int grp, int slot)
+{
+    int chain = -1;
+    int head = 0;
+    ccInstance *inst = &(instanceCache->instances[slot]);
+
+    if (instanceCache->groupChain[grp][slot] != 0)
+        return;
+
+    switch (grp) {
+    case INSTGRP_OWNER:
+        chain = instanceCacheGroupChain(grp, inst->ownerId, 0);
+        break;
+    case INSTGRP_VLAN:
+        chain = instanceCacheGroupChain(grp, NULL, instanceCache->summaries[slot].vlan);
+        break;
+    case INSTGRP_NODE:
+        chain = instanceCacheGroupChain(grp, NULL, instanceCache->summaries[slot].ncHostIdx);
+        break;
+    default:
+        break;
+    }
+    if (chain < 0)
+        return;
+
+    head = instanceCache->groupHead[grp][chain];
+    instanceCache->groupPrev[grp][slot] = 0;
+    instanceCache->groupNext[grp][slot] = head;
+    if (head)
+        instanceCache->groupPrev[grp][head - 1] = (slot + 1);
+    instanceCache->groupHead[grp][chain] = (slot + 1);
+    instanceCache->groupChain[grp][slot] = (chain + 1);
+}
+
+//!
+//! Unlinks a cache slot from its chain in the given secondary index
+//!
+//! @param[in] grp  the secondary index
+//! @param[in] slot the instance cache slot
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void instanceCacheGroupUnlink(int grp, int slot)
+{
+    int chain = instanceCache->groupChain[grp][slot] - 1;
+    int prev = instanceCache->groupPrev[grp][slot];
+    int next = instanceCache->groupNext[grp][slot];
+
+    if (chain < 0)
+        return;
+
+    if (prev)
+        instanceCache->groupNext[grp][prev - 1] = next;
+    else
+        instanceCache->groupHead[grp][chain] = next;
+    if (next)
+        instanceCache->groupPrev[grp][next - 1] = prev;
+
+    instanceCache->groupNext[grp][slot] = instanceCache->groupPrev[grp][slot] = 0;
+    instanceCache->groupChain[grp][slot] = 0;
+}
+
+//!
+//! Walks the valid cache slots having a key in a secondary index, as in
+//! for (i = instanceCacheGroupNext(grp, skey, ikey, -1); i >= 0; i = instanceCacheGroupNext(grp, skey, ikey, i))
+//!
+//! @param[in] grp  the secondary index
+//! @param[in] skey the owner ID, for INSTGRP_OWNER
+//! @param[in] ikey the VLAN or node index, for INSTGRP_VLAN and INSTGRP_NODE
+//! @param[in] slot the slot returned last, -1 to start the walk
+//!
+//! @return the next slot or -1 at the end
+//!
+//! @note this should be called with INSTCACHE lock held, a slot must not be unlinked while the walk is on it
+//!
+static int instanceCacheGroupNext(int grp, const char *skey, int ikey, int slot)
+{
+    int chain = 0;
+    int next = 0;
+
+    if (slot < 0) {
+        if ((chain = instanceCacheGroupChain(grp, skey, ikey)) < 0)
+            return (-1);
+        next = instanceCache->groupHead[grp][chain];
+    } else {
+        next = instanceCache->groupNext[grp][slot];
+    }
+
+    for (; next != 0; next = instanceCache->groupNext[grp][next - 1]) {
+        if ((instanceCache->cacheState[next - 1] == INSTVALID) && instanceCacheGroupMatch(grp, next - 1, skey, ikey))
+            return (next - 1);
+    }
+    return (-1);
+}
+
+//!
+//! Refreshes the summary of a cache slot from its full record and, if the slot is
+//! valid, adds it to all the lookup indexes. Must be called after the content of
+//! a slot has been modified.
+//!
+//! @param[in] slot the instance cache slot
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void index_instanceCacheSlot(int slot)
+{
+    int idx = 0;
+
+    if (instanceCache->cacheState[slot] != INSTVALID) {
+        bzero(&(instanceCache->summaries[slot]), sizeof(ccInstanceSummary));
+        return;
+    }
+
+    ccInstance_to_ccInstanceSummary(&(instanceCache->summaries[slot]), &(instanceCache->instances[slot]));
+    for (idx = 0; idx < INSTIDX_LAST; idx++)
+        instanceCacheIndexInsert(idx, slot);
+    for (idx = 0; idx < INSTGRP_LAST; idx++)
+        instanceCacheGroupLink(idx, slot);
+}
+
+//!
+//! Removes a cache slot from all the lookup indexes. Must be called before the
+//! slot's instance ID or addresses are modified.
+//!
+//! @param[in] slot the instance cache slot
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void unindex_instanceCacheSlot(int slot)
+{
+    int idx = 0;
+
+    // the secondary indexes remember their chain, so a slot is unlinked whatever it holds now
+    for (idx = 0; idx < INSTGRP_LAST; idx++)
+        instanceCacheGroupUnlink(idx, slot);
+
+    if (instanceCache->cacheState[slot] != INSTVALID)
+        return;
+
+    for (idx = 0; idx < INSTIDX_LAST; idx++)
+        instanceCacheIndexRemove(idx, slot);
+}
+
+//!
+//! Rebuilds the instance summaries and lookup indexes from the cache content. This is only
+//! needed the first time the shared cache is set up (or after an upgrade from a
+//! cache file which had no indexes).
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static void rebuild_instanceCacheIndex(void)
+{
+    int i = 0;
+
+    bzero(instanceCache->index, sizeof(instanceCache->index));
+    bzero(instanceCache->groupHead, sizeof(instanceCache->groupHead));
+    bzero(instanceCache->groupNext, sizeof(instanceCache->groupNext));
+    bzero(instanceCache->groupPrev, sizeof(instanceCache->groupPrev));
+    bzero(instanceCache->groupChain, sizeof(instanceCache->groupChain));
+    for (i = 0; i < MAXINSTANCES_PER_CC; i++)
+        index_instanceCacheSlot(i);
+    instanceCache->indexed = 1;
+}
+
 //!
 //!
 //!
@@ -8165,10 +10971,7 @@ int map_instanceCache(int (*match) (ccInstance *, void *), void *matchParam, int
 
     for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
         if (!match(&(instanceCache->instances[i]), matchParam)) {
-            if (operate(&(instanceCache->instances[i]), operateParam)) {
-                LOGWARN("instance cache mapping failed to operate at index %d\n", i);
-                ret++;
-            }
+            ret += map_instanceCacheSlot(i, operate, operateParam);
         }
     }
 
@@ -8176,6 +10979,37 @@ int map_instanceCache(int (*match) (ccInstance *, void *), void *matchParam, int
     return (ret);
 }
 
+//!
+//! Applies an operation to a cache slot, keeping its indexes and change time up to date
+//!
+//! @param[in] slot         the instance cache slot
+//! @param[in] operate      operation to apply
+//! @param[in] operateParam passed to operate
+//!
+//! @return 0 on success or 1 if the operation failed
+//!
+//! @note this should be called with INSTCACHE lock held
+//!
+static int map_instanceCacheSlot(int slot, int (*operate) (ccInstance *, void *), void *operateParam)
+{
+    int ret = 0;
+    ccInstanceSummary before = { {0} };
+
+    // the operation may change the addresses we are indexed under
+    memcpy(&before, &(instanceCache->summaries[slot]), sizeof(ccInstanceSummary));
+    unindex_instanceCacheSlot(slot);
+    if (operate(&(instanceCache->instances[slot]), operateParam)) {
+        LOGWARN("instance cache mapping failed to operate at index %d\n", slot);
+        ret++;
+    }
+    index_instanceCacheSlot(slot);
+    if (memcmp(&before, &(instanceCache->summaries[slot]), sizeof(ccInstanceSummary))) {
+        instanceCache->lastchanged[slot] = time(NULL);
+        checkpoint_journal_slot(slot);
+    }
+    return (ret);
+}
+
 //!
 //!
 //!
@@ -8188,8 +11022,8 @@ void print_instanceCache(void)
     sem_mywait(INSTCACHE);
     for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
         if (instanceCache->cacheState[i] == INSTVALID) {
-            LOGDEBUG("\tcache: %d/%d %s %s %s %s\n", i, instanceCache->numInsts, instanceCache->instances[i].instanceId,
-                     instanceCache->instances[i].ccnet.publicIp, instanceCache->instances[i].ccnet.privateIp, instanceCache->instances[i].state);
+            LOGDEBUG("\tcache: %d/%d %s %s %s %s\n", i, instanceCache->numInsts, instanceCache->summaries[i].instanceId,
+                     instanceCache->summaries[i].publicIp, instanceCache->summaries[i].privateIp, instanceCache->summaries[i].state);
         }
     }
     sem_mypost(INSTCACHE);
@@ -8313,18 +11147,56 @@ void invalidate_instanceCache(void)
     sem_mywait(INSTCACHE);
     for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
         // if instance is in teardown, free up network information
-        if (!strcmp(instanceCache->instances[i].state, "Teardown")) {
-            free_instanceNetwork(instanceCache->instances[i].ccnet.privateMac, instanceCache->instances[i].ccnet.vlan, 0, 0);
+        if (!strcmp(instanceCache->summaries[i].state, "Teardown")) {
+            free_instanceNetwork(instanceCache->summaries[i].privateMac, instanceCache->summaries[i].vlan, 0, 0);
         }
         if ((instanceCache->cacheState[i] == INSTVALID) && ((time(NULL) - instanceCache->lastseen[i]) > config->instanceTimeout)) {
-            LOGDEBUG("invalidating instance '%s' (last seen %ld seconds ago)\n", instanceCache->instances[i].instanceId, (time(NULL) - instanceCache->lastseen[i]));
+            LOGDEBUG("invalidating instance '%s' (last seen %ld seconds ago)\n", instanceCache->summaries[i].instanceId, (time(NULL) - instanceCache->lastseen[i]));
+            unindex_instanceCacheSlot(i);
             bzero(&(instanceCache->instances[i]), sizeof(ccInstance));
             instanceCache->lastseen[i] = 0;
+            instanceCache->lastchanged[i] = 0;
             instanceCache->cacheState[i] = INSTINVALID;
             instanceCache->numInsts--;
+            index_instanceCacheSlot(i);
+            checkpoint_journal_slot(i);
+        }
+    }
+    sem_mypost(INSTCACHE);
+}
+
+//!
+//! Marks a cached instance as seen without changing its content, for
+//! instances that a node reported as unchanged since the last update.
+//!
+//! @param[in]  instanceId the instance identifier string (i-XXXXXXXX)
+//! @param[out] transitional set if the cached instance is pending or migrating, may be NULL
+//!
+//! @return 0 if the instance is in the cache, 1 otherwise
+//!
+int touch_instanceCache(char *instanceId, boolean * transitional)
+{
+    int i = 0;
+    int ret = 1;
+
+    if (transitional) {
+        *transitional = FALSE;
+    }
+    if (!instanceId) {
+        return (1);
+    }
+
+    sem_mywait(INSTCACHE);
+    if ((i = instanceCacheIndexFind(INSTIDX_ID, instanceId)) >= 0) {
+        instanceCache->lastseen[i] = time(NULL);
+        if (transitional) {
+            *transitional = instance_in_transition(instanceCache->summaries[i].state, instanceCache->summaries[i].migration_state);
         }
+        ret = 0;
     }
     sem_mypost(INSTCACHE);
+
+    return (ret);
 }
 
 //!
@@ -8341,30 +11213,36 @@ void invalidate_instanceCache(void)
 //!
 int refresh_instanceCache(char *instanceId, ccInstance * in)
 {
-    int i, done;
+    int i;
+    int changed = 0;
 
     if (!instanceId || !in) {
         return (1);
     }
 
     sem_mywait(INSTCACHE);
-    done = 0;
-    for (i = 0; i < MAXINSTANCES_PER_CC && !done; i++) {
-        if (!strcmp(instanceCache->instances[i].instanceId, instanceId)) {
-            // in cache
-            // give precedence to instances that are in Extant/Pending over expired instances, when info comes from two different nodes
-            if (strcmp(in->serviceTag, instanceCache->instances[i].serviceTag) && strcmp(in->state, instanceCache->instances[i].state)
-                && !strcmp(in->state, "Teardown")) {
-                // skip
-                LOGDEBUG("skipping cache refresh with instance in Teardown (instance with non-Teardown from different node already cached)\n");
-            } else {
-                // update cached instance info
-                memcpy(&(instanceCache->instances[i]), in, sizeof(ccInstance));
-                instanceCache->lastseen[i] = time(NULL);
-            }
-            sem_mypost(INSTCACHE);
-            return (0);
+    if ((i = instanceCacheIndexFind(INSTIDX_ID, instanceId)) >= 0) {
+        // in cache
+        // give precedence to instances that are in Extant/Pending over expired instances, when info comes from two different nodes
+        if (strcmp(in->serviceTag, instanceCache->instances[i].serviceTag) && strcmp(in->state, instanceCache->instances[i].state)
+            && !strcmp(in->state, "Teardown")) {
+            // skip
+            LOGDEBUG("skipping cache refresh with instance in Teardown (instance with non-Teardown from different node already cached)\n");
+        } else {
+            // update cached instance info
+            if (memcmp(&(instanceCache->instances[i]), in, sizeof(ccInstance))) {
+                instanceCache->lastchanged[i] = time(NULL);
+                changed = 1;
+            }
+            unindex_instanceCacheSlot(i);
+            memcpy(&(instanceCache->instances[i]), in, sizeof(ccInstance));
+            index_instanceCacheSlot(i);
+            instanceCache->lastseen[i] = time(NULL);
+            if (changed)
+                checkpoint_journal_slot(i);
         }
+        sem_mypost(INSTCACHE);
+        return (0);
     }
     sem_mypost(INSTCACHE);
 
@@ -8387,26 +11265,33 @@ int refresh_instanceCache(char *instanceId, ccInstance * in)
 //!
 int add_instanceCache(char *instanceId, ccInstance * in)
 {
-    int i, done, firstNull = 0;
+    int i, firstNull = -1;
 
     if (!instanceId || !in) {
         return (1);
     }
 
     sem_mywait(INSTCACHE);
-    done = 0;
-    for (i = 0; i < MAXINSTANCES_PER_CC && !done; i++) {
-        if ((instanceCache->cacheState[i] == INSTVALID) && (!strcmp(instanceCache->instances[i].instanceId, instanceId))) {
-            // already in cache
-            LOGDEBUG("'%s/%s/%s' already in cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp);
-            instanceCache->lastseen[i] = time(NULL);
-            sem_mypost(INSTCACHE);
-            return (0);
-        } else if (instanceCache->cacheState[i] == INSTINVALID) {
+    if ((i = instanceCacheIndexFind(INSTIDX_ID, instanceId)) >= 0) {
+        // already in cache
+        LOGDEBUG("'%s/%s/%s' already in cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp);
+        instanceCache->lastseen[i] = time(NULL);
+        sem_mypost(INSTCACHE);
+        return (0);
+    }
+
+    for (i = 0; i < MAXINSTANCES_PER_CC && firstNull < 0; i++) {
+        if (instanceCache->cacheState[i] == INSTINVALID) {
             firstNull = i;
-            done++;
         }
     }
+
+    if (firstNull < 0) {
+        LOGERROR("instance cache is full, cannot add '%s'\n", instanceId);
+        sem_mypost(INSTCACHE);
+        return (1);
+    }
+
     LOGDEBUG("adding '%s/%s/%s/%d' to cache\n", instanceId, in->ccnet.publicIp, in->ccnet.privateIp, in->volumesSize);
     allocate_ccInstance(&(instanceCache->instances[firstNull]), in->instanceId, in->amiId, in->kernelId, in->ramdiskId, in->amiURL, in->kernelURL,
                         in->ramdiskURL, in->ownerId, in->accountId, in->state, in->ccState, in->ts, in->reservationId, &(in->ccnet), &(in->ncnet),
@@ -8414,7 +11299,10 @@ int add_instanceCache(char *instanceId, ccInstance * in)
                         in->groupNames, in->volumes, in->volumesSize, in->bundleTaskProgress);
     instanceCache->numInsts++;
     instanceCache->lastseen[firstNull] = time(NULL);
+    instanceCache->lastchanged[firstNull] = instanceCache->lastseen[firstNull];
     instanceCache->cacheState[firstNull] = INSTVALID;
+    index_instanceCacheSlot(firstNull);
+    checkpoint_journal_slot(firstNull);
 
     sem_mypost(INSTCACHE);
     return (0);
@@ -8436,16 +11324,16 @@ int del_instanceCacheId(char *instanceId)
     int i;
 
     sem_mywait(INSTCACHE);
-    for (i = 0; i < MAXINSTANCES_PER_CC; i++) {
-        if ((instanceCache->cacheState[i] == INSTVALID) && (!strcmp(instanceCache->instances[i].instanceId, instanceId))) {
-            // del from cache
-            bzero(&(instanceCache->instances[i]), sizeof(ccInstance));
-            instanceCache->lastseen[i] = 0;
-            instanceCache->cacheState[i] = INSTINVALID;
-            instanceCache->numInsts--;
-            sem_mypost(INSTCACHE);
-            return (0);
-        }
+    if ((i = instanceCacheIndexFind(INSTIDX_ID, instanceId)) >= 0) {
+        // del from cache
+        unindex_instanceCacheSlot(i);
+        bzero(&(instanceCache->instances[i]), sizeof(ccInstance));
+        instanceCache->lastseen[i] = 0;
+        instanceCache->lastchanged[i] = 0;
+        instanceCache->cacheState[i] = INSTINVALID;
+        instanceCache->numInsts--;
+        index_instanceCacheSlot(i);
+        checkpoint_journal_slot(i);
     }
     sem_mypost(INSTCACHE);
     return (0);
@@ -8474,33 +11362,31 @@ int find_instanceCacheId(char *instanceId, ccInstance ** out)
     sem_mywait(INSTCACHE);
     *out = NULL;
     done = 0;
-    for (i = 0; i < MAXINSTANCES_PER_CC && !done; i++) {
-        if (!strcmp(instanceCache->instances[i].instanceId, instanceId)) {
-            // found it
-            *out = EUCA_ZALLOC(1, sizeof(ccInstance));
-            if (!*out) {
-                LOGFATAL("out of memory!\n");
-                unlock_exit(1);
-            }
-
-            allocate_ccInstance(*out, instanceCache->instances[i].instanceId, instanceCache->instances[i].amiId, instanceCache->instances[i].kernelId,
-                                instanceCache->instances[i].ramdiskId, instanceCache->instances[i].amiURL, instanceCache->instances[i].kernelURL,
-                                instanceCache->instances[i].ramdiskURL, instanceCache->instances[i].ownerId, instanceCache->instances[i].accountId,
-                                instanceCache->instances[i].state, instanceCache->instances[i].ccState, instanceCache->instances[i].ts,
-                                instanceCache->instances[i].reservationId, &(instanceCache->instances[i].ccnet), &(instanceCache->instances[i].ncnet),
-                                &(instanceCache->instances[i].ccvm), instanceCache->instances[i].ncHostIdx, instanceCache->instances[i].keyName,
-                                instanceCache->instances[i].serviceTag, instanceCache->instances[i].userData, instanceCache->instances[i].launchIndex,
-                                instanceCache->instances[i].platform, instanceCache->instances[i].guestStateName, instanceCache->instances[i].bundleTaskStateName,
-                                instanceCache->instances[i].groupNames, instanceCache->instances[i].volumes, instanceCache->instances[i].volumesSize,
-                                instanceCache->instances[i].bundleTaskProgress);
-            LOGTRACE("found instance in cache '%s/%s/%s'\n", instanceCache->instances[i].instanceId,
-                     instanceCache->instances[i].ccnet.publicIp, instanceCache->instances[i].ccnet.privateIp);
-            // migration-related
-            // TO-DO: move to allocate_ccInstance() ?
-            (*out)->migration_state = instanceCache->instances[i].migration_state;
-            LOGTRACE("instance %s migration state=%s\n", instanceCache->instances[i].instanceId, migration_state_names[(*out)->migration_state]);
-            done++;
+    if ((i = instanceCacheIndexFind(INSTIDX_ID, instanceId)) >= 0) {
+        // found it
+        *out = EUCA_ZALLOC(1, sizeof(ccInstance));
+        if (!*out) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
+
+        allocate_ccInstance(*out, instanceCache->instances[i].instanceId, instanceCache->instances[i].amiId, instanceCache->instances[i].kernelId,
+                            instanceCache->instances[i].ramdiskId, instanceCache->instances[i].amiURL, instanceCache->instances[i].kernelURL,
+                            instanceCache->instances[i].ramdiskURL, instanceCache->instances[i].ownerId, instanceCache->instances[i].accountId,
+                            instanceCache->instances[i].state, instanceCache->instances[i].ccState, instanceCache->instances[i].ts,
+                            instanceCache->instances[i].reservationId, &(instanceCache->instances[i].ccnet), &(instanceCache->instances[i].ncnet),
+                            &(instanceCache->instances[i].ccvm), instanceCache->instances[i].ncHostIdx, instanceCache->instances[i].keyName,
+                            instanceCache->instances[i].serviceTag, instanceCache->instances[i].userData, instanceCache->instances[i].launchIndex,
+                            instanceCache->instances[i].platform, instanceCache->instances[i].guestStateName, instanceCache->instances[i].bundleTaskStateName,
+                            instanceCache->instances[i].groupNames, instanceCache->instances[i].volumes, instanceCache->instances[i].volumesSize,
+                            instanceCache->instances[i].bundleTaskProgress);
+        LOGTRACE("found instance in cache '%s/%s/%s'\n", instanceCache->instances[i].instanceId,
+                 instanceCache->instances[i].ccnet.publicIp, instanceCache->instances[i].ccnet.privateIp);
+        // migration-related
+        // TO-DO: move to allocate_ccInstance() ?
+        (*out)->migration_state = instanceCache->instances[i].migration_state;
+        LOGTRACE("instance %s migration state=%s\n", instanceCache->instances[i].instanceId, migration_state_names[(*out)->migration_state]);
+        done++;
     }
     sem_mypost(INSTCACHE);
     if (done) {
@@ -8532,30 +11418,30 @@ int find_instanceCacheIP(char *ip, ccInstance ** out)
     sem_mywait(INSTCACHE);
     *out = NULL;
     done = 0;
-    for (i = 0; i < MAXINSTANCES_PER_CC && !done; i++) {
-        if ((instanceCache->instances[i].ccnet.publicIp[0] != '\0' || instanceCache->instances[i].ccnet.privateIp[0] != '\0')) {
-            if (!strcmp(instanceCache->instances[i].ccnet.publicIp, ip) || !strcmp(instanceCache->instances[i].ccnet.privateIp, ip)) {
-                // found it
-                *out = EUCA_ZALLOC(1, sizeof(ccInstance));
-                if (!*out) {
-                    LOGFATAL("out of memory!\n");
-                    unlock_exit(1);
-                }
+    if ((i = instanceCacheIndexFind(INSTIDX_PUBLICIP, ip)) < 0) {
+        i = instanceCacheIndexFind(INSTIDX_PRIVATEIP, ip);
+    }
 
-                allocate_ccInstance(*out, instanceCache->instances[i].instanceId, instanceCache->instances[i].amiId,
-                                    instanceCache->instances[i].kernelId, instanceCache->instances[i].ramdiskId, instanceCache->instances[i].amiURL,
-                                    instanceCache->instances[i].kernelURL, instanceCache->instances[i].ramdiskURL,
-                                    instanceCache->instances[i].ownerId, instanceCache->instances[i].accountId, instanceCache->instances[i].state,
-                                    instanceCache->instances[i].ccState, instanceCache->instances[i].ts, instanceCache->instances[i].reservationId,
-                                    &(instanceCache->instances[i].ccnet), &(instanceCache->instances[i].ncnet), &(instanceCache->instances[i].ccvm),
-                                    instanceCache->instances[i].ncHostIdx, instanceCache->instances[i].keyName,
-                                    instanceCache->instances[i].serviceTag, instanceCache->instances[i].userData,
-                                    instanceCache->instances[i].launchIndex, instanceCache->instances[i].platform,
-                                    instanceCache->instances[i].guestStateName, instanceCache->instances[i].bundleTaskStateName, instanceCache->instances[i].groupNames,
-                                    instanceCache->instances[i].volumes, instanceCache->instances[i].volumesSize, instanceCache->instances[i].bundleTaskProgress);
-                done++;
-            }
+    if (i >= 0) {
+        // found it
+        *out = EUCA_ZALLOC(1, sizeof(ccInstance));
+        if (!*out) {
+            LOGFATAL("out of memory!\n");
+            unlock_exit(1);
         }
+
+        allocate_ccInstance(*out, instanceCache->instances[i].instanceId, instanceCache->instances[i].amiId,
+                            instanceCache->instances[i].kernelId, instanceCache->instances[i].ramdiskId, instanceCache->instances[i].amiURL,
+                            instanceCache->instances[i].kernelURL, instanceCache->instances[i].ramdiskURL,
+                            instanceCache->instances[i].ownerId, instanceCache->instances[i].accountId, instanceCache->instances[i].state,
+                            instanceCache->instances[i].ccState, instanceCache->instances[i].ts, instanceCache->instances[i].reservationId,
+                            &(instanceCache->instances[i].ccnet), &(instanceCache->instances[i].ncnet), &(instanceCache->instances[i].ccvm),
+                            instanceCache->instances[i].ncHostIdx, instanceCache->instances[i].keyName,
+                            instanceCache->instances[i].serviceTag, instanceCache->instances[i].userData,
+                            instanceCache->instances[i].launchIndex, instanceCache->instances[i].platform,
+                            instanceCache->instances[i].guestStateName, instanceCache->instances[i].bundleTaskStateName, instanceCache->instances[i].groupNames,
+                            instanceCache->instances[i].volumes, instanceCache->instances[i].volumesSize, instanceCache->instances[i].bundleTaskProgress);
+        done++;
     }
 
     sem_mypost(INSTCACHE);
@@ -8565,6 +11451,240 @@ int find_instanceCacheIP(char *ip, ccInstance ** out)
     return (1);
 }
 
+//!
+//! Marks the beginning of a write section on the resource cache. The sequence number
+//! is made odd so lock-free readers know their copy may be torn. Forcing the parity
+//! (rather than incrementing) recovers from a writer which died mid-section.
+//!
+//! @note this must be called with RESCACHE lock held, see sem_mywait()
+//!
+static void resourceCacheWriteBegin(void)
+{
+    resourceCache->seq = ((resourceCache->seq + 1) | 1);
+    __sync_synchronize();
+}
+
+//!
+//! Marks the end of a write section on the resource cache, making the sequence number even
+//!
+//! @note this must be called with RESCACHE lock held, see sem_mypost()
+//!
+static void resourceCacheWriteEnd(void)
+{
+    __sync_synchronize();
+    resourceCache->seq = ((resourceCache->seq + 1) & ~1U);
+}
+
+//!
+//! Tells how many instances of a VM type fit in some capacity
+//!
+//! @param[in] type  the VM type
+//! @param[in] mem   memory of the capacity
+//! @param[in] disk  disk of the capacity
+//! @param[in] cores cores of the capacity
+//!
+//! @return the number of instances, 0 if the capacity is exhausted
+//!
+static int resourceTypeFit(ccResourceType * type, int mem, int disk, int cores)
+{
+    int fit = 0;
+
+    if ((mem < type->mem) || (disk < type->disk) || (cores < type->cores))
+        return (0);
+
+    fit = (mem / type->mem);
+    fit = MIN(fit, (disk / type->disk));
+    fit = MIN(fit, (cores / type->cores));
+    return (fit);
+}
+
+//!
+//! Brings the per VM type availability of the resource cache up to date with the capacity of
+//! a node, by taking off what the node was counted for and adding what it has now. Whatever
+//! changes the capacity or the state of a node calls this, so that doDescribeResources() only
+//! has to read the counts.
+//!
+//! @param[in] idx the index of the node in the resource cache
+//!
+//! @note this must be called with RESCACHE lock held, see sem_mywait()
+//!
+static void count_resourceCacheNode(int idx)
+{
+    int i = 0;
+    ccResource *res = NULL;
+    ccResourceType *type = NULL;
+    ccResourceCapacity now = { 0 };
+    ccResourceCapacity *was = NULL;
+
+    if (!resourceCache->typesValid || (idx < 0) || (idx >= resourceCache->numResources))
+        return;
+
+    res = &(resourceCache->resources[idx]);
+    if (res->ncState != STOPPED) {
+        now.availMemory = res->availMemory;
+        now.availDisk = res->availDisk;
+        now.availCores = res->availCores;
+        now.maxMemory = res->maxMemory;
+        now.maxDisk = res->maxDisk;
+        now.maxCores = res->maxCores;
+    }
+
+    was = &(resourceCache->counted[idx]);
+    if (!memcmp(was, &now, sizeof(ccResourceCapacity)))
+        return;
+
+    for (i = 0; i < resourceCache->numTypes; i++) {
+        type = &(resourceCache->types[i]);
+        type->avail += (resourceTypeFit(type, now.availMemory, now.availDisk, now.availCores) - resourceTypeFit(type, was->availMemory, was->availDisk, was->availCores));
+        type->max += (resourceTypeFit(type, now.maxMemory, now.maxDisk, now.maxCores) - resourceTypeFit(type, was->maxMemory, was->maxDisk, was->maxCores));
+    }
+    *was = now;
+}
+
+//!
+//! Counts the per VM type availability of the resource cache again from the capacity of every
+//! node, after the VM types changed or nodes moved in the cache
+//!
+//! @note this must be called with RESCACHE lock held, see sem_mywait()
+//!
+static void recount_resourceCacheTypes(void)
+{
+    int i = 0;
+
+    for (i = 0; i < resourceCache->numTypes; i++) {
+        resourceCache->types[i].avail = 0;
+        resourceCache->types[i].max = 0;
+    }
+    bzero(resourceCache->counted, sizeof(resourceCache->counted));
+
+    resourceCache->typesValid = TRUE;
+    for (i = 0; i < resourceCache->numResources; i++) {
+        count_resourceCacheNode(i);
+    }
+}
+
+//!
+//! Returns the number of resources (nodes) currently in the canonical cache without locking
+//!
+//! @return the number of resources
+//!
+int get_resourceCacheSize(void)
+{
+    int num = resourceCache->numResources;
+
+    if ((num < 0) || (num > MAXNODES))
+        return (0);
+    return (num);
+}
+
+//!
+//! Takes a consistent copy of a single resource (node) from the canonical cache. This
+//! is a seqlock-style read: the entry is copied without taking RESCACHE and the copy
+//! is retried if a writer held the lock meanwhile. The cost does not depend on the
+//! number of nodes, unlike copying the whole ccResourceCache.
+//!
+//! @param[in]  idx the index of the resource in the cache
+//! @param[out] out a pointer to the resource structure to fill
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the index is out of range
+//!
+int get_resourceCacheEntry(int idx, ccResource * out)
+{
+    int i = 0;
+    int ret = EUCA_ERROR;
+    unsigned int seq = 0;
+
+    if (!out || (idx < 0) || (idx >= MAXNODES))
+        return (EUCA_ERROR);
+
+    for (i = 0; i < RESCACHE_READ_RETRIES; i++) {
+        seq = resourceCache->seq;
+        __sync_synchronize();
+        if (!(seq & 1)) {
+            ret = EUCA_ERROR;
+            if (idx < resourceCache->numResources) {
+                memcpy(out, &(resourceCache->resources[idx]), sizeof(ccResource));
+                ret = EUCA_OK;
+            }
+            __sync_synchronize();
+            if (resourceCache->seq == seq)
+                return (ret);
+        }
+        sched_yield();
+    }
+
+    // too much write contention, pay for the lock
+    sem_mywait(RESCACHE);
+    {
+        ret = EUCA_ERROR;
+        if (idx < resourceCache->numResources) {
+            memcpy(out, &(resourceCache->resources[idx]), sizeof(ccResource));
+            ret = EUCA_OK;
+        }
+    }
+    sem_mypost(RESCACHE);
+    return (ret);
+}
+
+//!
+//! Finds the first resource (node) of the canonical cache matching the given criteria
+//! and takes a consistent copy of it. Entries are matched in place, so only the found
+//! entry gets copied.
+//!
+//! @param[in]  match the matching function, returns 0 on match (see pubIpCmp())
+//! @param[in]  matchParam the parameter passed to the matching function
+//! @param[out] out a pointer to the resource structure to fill
+//! @param[out] outIdx if not NULL, set to the index of the resource in the cache
+//!
+//! @return EUCA_OK if a resource was found or EUCA_ERROR otherwise
+//!
+int find_resourceCacheEntry(int (*match) (ccResource *, void *), void *matchParam, ccResource * out, int *outIdx)
+{
+    int i = 0;
+    int try = 0;
+    int idx = -1;
+    unsigned int seq = 0;
+
+    if (!match || !out)
+        return (EUCA_ERROR);
+
+    for (try = 0; try < RESCACHE_READ_RETRIES; try++) {
+        seq = resourceCache->seq;
+        __sync_synchronize();
+        if (!(seq & 1)) {
+            for (i = 0, idx = -1; (i < resourceCache->numResources) && (i < MAXNODES) && (idx < 0); i++) {
+                if (!match(&(resourceCache->resources[i]), matchParam))
+                    idx = i;
+            }
+            if (idx >= 0)
+                memcpy(out, &(resourceCache->resources[idx]), sizeof(ccResource));
+            __sync_synchronize();
+            if (resourceCache->seq == seq)
+                break;
+        }
+        idx = -1;
+        sched_yield();
+    }
+
+    if (try == RESCACHE_READ_RETRIES) {
+        // too much write contention, pay for the lock
+        sem_mywait(RESCACHE);
+        {
+            for (i = 0, idx = -1; (i < resourceCache->numResources) && (idx < 0); i++) {
+                if (!match(&(resourceCache->resources[i]), matchParam))
+                    idx = i;
+            }
+            if (idx >= 0)
+                memcpy(out, &(resourceCache->resources[idx]), sizeof(ccResource));
+        }
+        sem_mypost(RESCACHE);
+    }
+
+    if (outIdx)
+        *outIdx = idx;
+    return ((idx >= 0) ? EUCA_OK : EUCA_ERROR);
+}
+
 //!
 //! Prints all resources (nodes) in the canonical cache
 //!
@@ -8648,6 +11768,7 @@ static void reconfigure_resourceCache(ccResource * res, int numHosts)
                 memcpy(resourceCache->resources + resourceCache->numResources, res_new, sizeof(ccResource));
                 resourceCache->cacheState[resourceCache->numResources] = RES_CONFIGURED;
                 resourceCache->numResources++;
+                count_resourceCacheNode(resourceCache->numResources - 1);
                 num_added++;
             }
         }
@@ -8689,22 +11810,19 @@ static int reindex_instanceCache(int removed_index, ccResource * removed_resourc
     // reset the indexes of all concerned instances, atomically
     sem_mywait(INSTCACHE);
     {
-        for (int i = 0; i < MAXINSTANCES_PER_CC; i++) {
-            ccInstance *inst = instanceCache->instances + i;
-
-            if ((instanceCache->cacheState[i] == INSTVALID) &&  // a valid instance slot
-                (inst->ncHostIdx == removed_index)) {   // is pointing to the host being removed
-                LOGWARN("BUG: instance struct (%s) points to node to be removed (%s)\n", inst->instanceId, removed_resource->hostname);
-                ret = EUCA_ERROR;
-                break;
-            }
+        int i = instanceCacheGroupNext(INSTGRP_NODE, NULL, removed_index, -1);
+        if (i >= 0) {                  // an instance is pointing to the host being removed
+            LOGWARN("BUG: instance struct (%s) points to node to be removed (%s)\n", instanceCache->summaries[i].instanceId, removed_resource->hostname);
+            ret = EUCA_ERROR;
         }
         if (ret == EUCA_OK) {
-            for (int i = 0; i < MAXINSTANCES_PER_CC; i++) {
-                ccInstance *inst = instanceCache->instances + i;
-                if ((instanceCache->cacheState[i] == INSTVALID) &&  // a valid instance slot
-                    (inst->ncHostIdx > removed_index)) {    // host index bigger than one being removed
-                    inst->ncHostIdx--;
+            // only the nodes past the removed one move, and their instances with them
+            for (int n = removed_index + 1; n < MAXNODES; n++) {
+                while ((i = instanceCacheGroupNext(INSTGRP_NODE, NULL, n, -1)) >= 0) {
+                    instanceCacheGroupUnlink(INSTGRP_NODE, i);
+                    instanceCache->summaries[i].ncHostIdx--;
+                    instanceCache->instances[i].ncHostIdx = instanceCache->summaries[i].ncHostIdx;
+                    instanceCacheGroupLink(INSTGRP_NODE, i);
                 }
             }
         }
@@ -8758,12 +11876,15 @@ static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolea
                                 memmove(res_old, res_old + 1, sizeof(ccResource) * (resourceCache->numResources - j));
                                 memmove(resourceCache->cacheState + j, resourceCache->cacheState + (j + 1), sizeof(int) * (resourceCache->numResources - j));
                                 resourceCache->numResources--;
+                                // the nodes past it moved, so their counted capacity no longer lines up
+                                resourceCache->typesValid = FALSE;
                             }
                         } else {
                             LOGWARN("node '%s' not in configuration, but with instances on it\n", res_old->hostname);
                         }
                     } else {           // a configured resource, so just update cache with latest info
                         memcpy(res_old, res_new, sizeof(ccResource));
+                        count_resourceCacheNode(j);
                     }
                     found_it = TRUE;
                     break;
@@ -8796,7 +11917,7 @@ void unlock_exit(int code)
     for (i = 0; i < ENDLOCK; i++) {
         if (mylocks[i]) {
             LOGWARN("unlocking index '%d'\n", i);
-            sem_post(locks[i]);
+            sem_mypost(i);
         }
     }
     exit(code);
@@ -8818,6 +11939,10 @@ int sem_mywait(int lockno)
     int rc;
     rc = sem_wait(locks[lockno]);
     mylocks[lockno] = 1;
+    if ((lockno == RESCACHE) && resourceCache) {
+        // every RESCACHE holder is treated as a writer by lock-free readers
+        resourceCacheWriteBegin();
+    }
     return (rc);
 }
 
@@ -8834,158 +11959,69 @@ int sem_mywait(int lockno)
 //!
 int sem_mypost(int lockno)
 {
+    if ((lockno == RESCACHE) && resourceCache) {
+        resourceCacheWriteEnd();
+    }
     mylocks[lockno] = 0;
     return (sem_post(locks[lockno]));
 }
 
 //!
+//! Starts staging an image in the image proxy, in the background
 //!
+//! @param[in] id the identifier of the image
+//! @param[in] url the object storage URL of the image manifest
 //!
-//! @param[in] id
-//! @param[in] url
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 if the image is cached or on its way, so that its proxy URL can be handed out,
+//!         or 1 on error
 //!
 int image_cache(char *id, char *url)
 {
-    int rc;
-    int pid;
-    char path[EUCA_MAX_PATH], finalpath[EUCA_MAX_PATH];
+    char dataDir[EUCA_MAX_PATH] = "";
 
-    if (url && id) {
-        pid = fork();
-        if (!pid) {
-            snprintf(finalpath, EUCA_MAX_PATH, "%s/data/%s.manifest.xml", config->proxyPath, id);
-            snprintf(path, EUCA_MAX_PATH, "%s/data/%s.manifest.xml.staging", config->proxyPath, id);
-            if (check_file(path) && check_file(finalpath)) {
-                rc = objectstorage_object_by_url(url, path, 0);
-                if (rc) {
-                    LOGERROR("could not cache image manifest (%s/%s)\n", id, url);
-                    unlink(path);
-                    exit(1);
-                }
-                rename(path, finalpath);
-                chmod(finalpath, 0600);
-            }
-            snprintf(path, EUCA_MAX_PATH, "%s/data/%s.staging", config->proxyPath, id);
-            snprintf(finalpath, EUCA_MAX_PATH, "%s/data/%s", config->proxyPath, id);
-            if (check_file(path) && check_file(finalpath)) {
-                rc = objectstorage_image_by_manifest_url(url, path, 1);
-                if (rc) {
-                    LOGERROR("could not cache image (%s/%s)\n", id, url);
-                    unlink(path);
-                    exit(1);
-                }
-                rename(path, finalpath);
-                chmod(finalpath, 0600);
-            }
-            exit(0);
-        }
-    }
+    if (!url || !id)
+        return (1);
 
-    return (0);
+    snprintf(dataDir, EUCA_MAX_PATH, "%s/data", config->proxyPath);
+    return ((image_proxy_prefetch(dataDir, id, url) == EUCA_OK) ? 0 : 1);
 }
 
 //!
+//! Keeps the image proxy under proxy_max_cache_size, removing the least recently used
+//! images first
 //!
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success or 1 on error
 //!
 int image_cache_invalidate(void)
 {
-    time_t oldest;
-    char proxyPath[EUCA_MAX_PATH], path[EUCA_MAX_PATH], oldestpath[EUCA_MAX_PATH], oldestmanifestpath[EUCA_MAX_PATH];
-    DIR *DH = NULL;
-    struct dirent dent, *result = NULL;
-    struct stat mystat;
-    int rc, total_megs = 0;
+    char dataDir[EUCA_MAX_PATH] = "";
 
-    if (config->use_proxy) {
-        proxyPath[0] = '\0';
-        path[0] = '\0';
-        oldestpath[0] = '\0';
-        oldestmanifestpath[0] = '\0';
-
-        oldest = time(NULL);
-        snprintf(proxyPath, EUCA_MAX_PATH, "%s/data", config->proxyPath);
-        DH = opendir(proxyPath);
-        if (!DH) {
-            LOGERROR("could not open dir '%s'\n", proxyPath);
-            return (1);
-        }
-
-        rc = readdir_r(DH, &dent, &result);
-        while (!rc && result) {
-            if (strcmp(dent.d_name, ".") && strcmp(dent.d_name, "..") && !strstr(dent.d_name, "manifest.xml") && strcmp(dent.d_name, "network-topology")
-                && strcmp(dent.d_name, "config-cc")) {
-                snprintf(path, EUCA_MAX_PATH, "%s/%s", proxyPath, dent.d_name);
-                rc = stat(path, &mystat);
-                if (!rc) {
-                    LOGDEBUG("evaluating file: name=%s size=%ld atime=%ld'\n", dent.d_name, mystat.st_size / 1048576, mystat.st_atime);
-                    if (mystat.st_atime < oldest) {
-                        oldest = mystat.st_atime;
-                        snprintf(oldestpath, EUCA_MAX_PATH, "%s", path);
-                        snprintf(oldestmanifestpath, EUCA_MAX_PATH, "%s.manifest.xml", path);
-                    }
-                    total_megs += mystat.st_size / 1048576;
-                }
-            }
-            rc = readdir_r(DH, &dent, &result);
-        }
-        closedir(DH);
-        LOGDEBUG("summary: totalMBs=%d oldestAtime=%ld oldestFile=%s\n", total_megs, oldest, oldestpath);
-        if (total_megs > config->proxy_max_cache_size) {
-            // start slowly deleting
-            LOGINFO("invalidating cached image %s\n", oldestpath);
-            unlink(oldestpath);
-            unlink(oldestmanifestpath);
-        }
-    }
+    if (!config->use_proxy)
+        return (0);
 
-    return (0);
+    snprintf(dataDir, EUCA_MAX_PATH, "%s/data", config->proxyPath);
+    return ((image_proxy_evict(dataDir, config->proxy_max_cache_size) == EUCA_OK) ? 0 : 1);
 }
 
 //!
+//! Prepares the image proxy for the nodes. The proxy checks the address of each download
+//! against the resource cache, so a change in the nodes only needs the data directory to
+//! be there; the monitor starts the proxy itself.
 //!
+//! @param[in] res the nodes of the cluster
+//! @param[in] numHosts the number of nodes
 //!
-//! @param[in]  res
-//! @param[out] numHosts
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success or 1 on error
 //!
 int image_cache_proxykick(ccResource * res, int *numHosts)
 {
-    int i = 0;
-    int rc = 0;
-    char *nodestr = NULL;
-    char cmd[EUCA_MAX_PATH] = "";
-
-    if ((nodestr = EUCA_ZALLOC((((*numHosts) * 128) + (*numHosts) + 1), sizeof(char))) == NULL) {
-        LOGFATAL("out of memory!\n");
-        unlock_exit(1);
-    }
+    char dataDir[EUCA_MAX_PATH] = "";
 
-    for (i = 0; i < (*numHosts); i++) {
-        strcat(nodestr, res[i].hostname);
-        strcat(nodestr, " ");
+    snprintf(dataDir, EUCA_MAX_PATH, "%s/data", config->proxyPath);
+    if (ensure_directories_exist(dataDir, 0, NULL, NULL, 0700) == -1) {
+        LOGERROR("cannot create image proxy directory %s\n", dataDir);
+        return (1);
     }
-
-    snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_HELPER_DIR "/dynserv.pl %s %s", config->eucahome, config->proxyPath, nodestr);
-    LOGDEBUG("running cmd '%s'\n", cmd);
-    rc = system(cmd);
-
-    EUCA_FREE(nodestr);
-    return (rc);
+    LOGDEBUG("image proxy ready for %d node(s)\n", *numHosts);
+    return (0);
 }
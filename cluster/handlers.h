@@ -94,9 +94,28 @@
 #define OP_TIMEOUT                               60
 #define OP_TIMEOUT_PERNODE                       20
 #define OP_TIMEOUT_MIN                            5
+#define INSTANCE_INDEX_SIZE                      (2 * MAXINSTANCES_PER_CC)    //! buckets per instance cache lookup index, power of 2
+#define INSTANCE_GROUP_CHAINS                    4096   //! chains per instance cache secondary index, power of 2 and no less than MAXNODES or the VLANs
+#define RESCACHE_READ_RETRIES                    16 //! lock-free resource cache read attempts before falling back to RESCACHE
+#define RESCACHE_MAX_VM_TYPES                    32 //! most VM types whose availability the resource cache keeps counted
+#define NC_POOL_STUB_MAX_CALLS                  500 //! calls made through a pooled NC stub before it is recycled
+#define NC_POOL_STUB_MAX_BYTES   (16 * 1024 * 1024) //! bytes the arena of a pooled NC stub may hold before the stub is recycled
+#define NC_FANOUT_REAP_TIMEOUT                  120 //! seconds a per-NC refresh child may run before it is terminated
+#define NC_FANOUT_TERM_GRACE                      5 //! seconds a per-NC child has to exit once terminated, before it is given up on
+#define NC_LATENCY_BUCKETS                        8 //! buckets in the per-NC request latency histogram
+#define NC_LATENCY_SLOW_MS                     2000 //! NCs whose last refresh took longer than this get logged
+#define NC_LATENCY_RECENT                        32 //! latest per-NC request latencies kept for the adaptive timeout
+#define NC_ADAPTIVE_TIMEOUT_PCT                  95 //! percentile of the recent latencies of an NC its adaptive timeout is based on
+#define NC_ADAPTIVE_TIMEOUT_FACTOR                4 //! multiple of that percentile an NC is given before its request times out
+#define NC_BREAKER_FAILURES                       3 //! consecutive failed polls after which the circuit of an NC opens
+#define NC_BREAKER_BACKOFF_MIN                   15 //! seconds the circuit of an NC first stays open, doubled on every failed probe
+#define NC_BREAKER_BACKOFF_MAX                  600 //! longest a circuit stays open before the NC is probed again
+#define NC_DESCRIBE_FULL_RESYNC_SEC              60 //! maximum interval between full (non-incremental) DescribeInstances
+#define NC_POLL_GROWTH                            2 //! factor by which the polling interval of a node without instances in transition grows
+#define NCCALL_UNLOCKED                          -1 //! ncClientCall() lock for calls that need not wait for the other calls to the same NC
 #define LOG_INTERVAL_SUMMARY_SEC                 60
+#define MONITOR_TASK_RETRY_SEC                    1 //! seconds before a monitor task that asked for a retry runs again
 #define SCHED_TIMEOUT_SEC                         8 //! timeout for user scheduler
-#define MESSAGE_STATS_MEMORY_REGION_SIZE         10485760 //! 10 MB
 
 /*
 {
@@ -128,10 +147,10 @@ enum {
     INSTCACHE,
     RESCACHE,
     RESCACHESTAGE,
-    REFRESHLOCK,
     BUNDLECACHE,
     SENSORCACHE,
     STATSCACHE,
+    TRACERING,
     GLOBALNETWORKINFO,
     NCCALL0,
     NCCALL1,
@@ -192,6 +211,22 @@ enum {
     INSTCONFLICT,
 };
 
+//! Lookup indexes kept over the instance cache
+enum {
+    INSTIDX_ID,
+    INSTIDX_PUBLICIP,
+    INSTIDX_PRIVATEIP,
+    INSTIDX_LAST,
+};
+
+//! Secondary indexes kept over the instance cache, each chaining together the instances sharing a key
+enum {
+    INSTGRP_OWNER,                     //!< by ownerId, the user
+    INSTGRP_VLAN,                      //!< by VLAN, which is how the CC tells networks apart
+    INSTGRP_NODE,                      //!< by ncHostIdx
+    INSTGRP_LAST,
+};
+
 enum {
     RES_UNCONFIGURED = 0,
     RES_CONFIGURED,
@@ -205,6 +240,21 @@ enum {
     NUM_THREADS,
 };
 
+//! Periodic jobs of the monitor, each run by its own worker process, see monitor_thread()
+enum {
+    MONITOR_TASK_RESOURCES,
+    MONITOR_TASK_INSTANCES,
+    MONITOR_TASK_SENSORS,
+    MONITOR_TASK_BROADCAST,
+    MONITOR_TASK_NETWORK,
+    MONITOR_TASK_CLC,
+    MONITOR_TASK_PROXY,
+    MONITOR_TASK_CONSOLIDATE,
+    MONITOR_TASK_SUMMARY,
+    MONITOR_TASK_EVENTS,
+    MONITOR_TASK_LAST,
+};
+
 enum {
     CONFIGLOCK,
     CACHELOCK,
@@ -216,9 +266,41 @@ enum {
     SCHEDROUNDROBIN,
     SCHEDPOWERSAVE,
     SCHEDUSER,
+    SCHEDBINPACK,
+    SCHEDSPREAD,
     SCHEDLAST,
 };
 
+//! Operations that ncClientCall() performs on an NC, indexing the table of their stubs and serializers
+typedef enum ncOpId_t {
+    NC_OP_GET_CONSOLE_OUTPUT,
+    NC_OP_ATTACH_VOLUME,
+    NC_OP_DETACH_VOLUME,
+    NC_OP_CREATE_IMAGE,
+    NC_OP_POWER_DOWN,
+    NC_OP_ASSIGN_ADDRESS,
+    NC_OP_BROADCAST_NETWORK_INFO,
+    NC_OP_REBOOT_INSTANCE,
+    NC_OP_TERMINATE_INSTANCE,
+    NC_OP_START_NETWORK,
+    NC_OP_RUN_INSTANCE,
+    NC_OP_DESCRIBE_INSTANCES,
+    NC_OP_DESCRIBE_INSTANCES_DELTA,
+    NC_OP_DESCRIBE_RESOURCE,
+    NC_OP_DESCRIBE_SENSORS,
+    NC_OP_DESCRIBE_SENSORS_BATCHED,
+    NC_OP_BUNDLE_INSTANCE,
+    NC_OP_BUNDLE_RESTART_INSTANCE,
+    NC_OP_CANCEL_BUNDLE_TASK,
+    NC_OP_MODIFY_NODE,
+    NC_OP_MIGRATE_INSTANCES,
+    NC_OP_START_INSTANCE,
+    NC_OP_STOP_INSTANCE,
+    NC_OP_TERMINATE_INSTANCES,
+    NC_OP_REBOOT_INSTANCES,
+    NC_OPS,                            //!< number of operations, not an operation
+} ncOpId;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
@@ -276,6 +358,57 @@ typedef struct instance_t {
     long long netbytes;
 } ccInstance;
 
+//! Which refresh request a per-NC latency histogram tracks
+enum {
+    NCLAT_DESCRIBE_RESOURCE,
+    NCLAT_DESCRIBE_INSTANCES,
+    NCLAT_LAST,
+};
+
+//! Latency of the periodic requests sent to one NC, so that slow nodes stand out
+typedef struct ncLatency_t {
+    int count;                         //!< number of requests measured
+    int timeouts;                      //!< number of requests terminated at their deadline
+    int lastMs;                        //!< latency of the most recent request
+    int maxMs;                         //!< worst latency seen
+    long long totalMs;                 //!< sum of all latencies, for the mean
+    int buckets[NC_LATENCY_BUCKETS];   //!< histogram, upper bounds are in nc_latency_bounds_ms[]
+    int recentMs[NC_LATENCY_RECENT];   //!< ring of the latest latencies, for the adaptive timeout
+    int recentNext;                    //!< slot of recentMs[] the next latency goes in
+} ncLatency;
+
+//! States of the circuit breaker of an NC, see nc_health_allow()
+enum {
+    NCHEALTH_CLOSED,                   //!< the NC is polled as usual
+    NCHEALTH_OPEN,                     //!< the NC failed too often, it is left alone until its backoff runs out
+    NCHEALTH_HALF_OPEN,                //!< a probe is out to an NC whose circuit was open
+};
+
+//! Health of one NC, so that a node that stopped answering does not slow down the polling of the others
+typedef struct ncHealth_t {
+    int state;                         //!< NCHEALTH_* state of the circuit
+    int failures;                      //!< consecutive failed polls
+    int backoff;                       //!< seconds the circuit stays open the next time it opens
+    time_t retryAt;                    //!< when the next probe may be sent, if the circuit is not closed
+    int trips;                         //!< number of times the circuit opened
+} ncHealth;
+
+//! State of a monitor task, kept up to date by its worker and watched by the monitor
+typedef struct ccMonitorTask_t {
+    int pid;                           //!< the worker process running the task
+    int running;                       //!< set while a run is in progress
+    time_t nextRun;                    //!< when the next run is due, 0 for as soon as the CC is enabled
+    int kicked;                        //!< set to have the task run again as soon as possible, whenever it is due
+    long long lastStart;               //!< when the current or last run started, in milliseconds
+    long long lastEnd;                 //!< when the last run ended, in milliseconds
+    long lastDuration;                 //!< how long the last run took, in milliseconds
+    long maxDuration;                  //!< longest run so far, in milliseconds
+    long long runs;                    //!< number of runs completed
+    long long skipped;                 //!< runs that fell due while the previous one was still going
+    long long overruns;                //!< runs that took longer than the task deadline
+    int lastRc;                        //!< what the last run returned
+} ccMonitorTask;
+
 typedef struct resource_t {
     char ncURL[384];
     char ncService[128];
@@ -300,23 +433,96 @@ typedef struct resource_t {
     char nodeStatus[24];
     boolean migrationCapable;
     char hypervisor[16];
+    ncLatency latency[NCLAT_LAST];
+    ncHealth health;                   //!< circuit breaker of the node, see nc_health_allow()
+    long long instGeneration;          //!< generation of the node's instance list at the last DescribeInstances, 0 to force a full update
+    time_t instLastFullSync;           //!< when the last full (non-incremental) DescribeInstances succeeded
+    time_t pollInterval;               //!< seconds between polls of the node, between ncPollingMin and ncPollingMax, see nc_poll_adapt()
+    time_t lastResPoll;                //!< when DescribeResource was last sent to the node
+    time_t lastInstPoll;               //!< when DescribeInstances was last sent to the node, 0 to poll it on the next refresh
 } ccResource;
 
+//! Frequently accessed subset of a cached ccInstance. Sweeps over the instance cache
+//! that only need these fields walk the dense summary array instead of pulling every
+//! full (20KB+) ccInstance record into the CPU caches.
+typedef struct ccInstanceSummary_t {
+    char instanceId[16];
+    char state[16];
+    time_t ts;
+    int ncHostIdx;
+    migration_states migration_state;
+    int vlan;
+    int networkIndex;
+    char privateMac[MAC_BUFFER_SIZE];
+    char publicIp[IP_BUFFER_SIZE];
+    char privateIp[IP_BUFFER_SIZE];
+} ccInstanceSummary;
+
+//! Optional filters, projection and paging of a DescribeInstances request, along with
+//! what doDescribeInstances() tells about the page it returned
+typedef struct ccInstanceQuery_t {
+    char **states;                     //!< only instances in one of these states, if statesLen > 0
+    int statesLen;                     //!< number of entries in states
+    char **ownerIds;                   //!< only instances of one of these owners, if ownerIdsLen > 0
+    int ownerIdsLen;                   //!< number of entries in ownerIds
+    time_t changedSince;               //!< if set, matching instances that did not change since then are only listed in unchangedIds
+    boolean excludeUserData;           //!< leave userData out of the returned instances
+    int maxResults;                    //!< most instances returned in full per page, 0 for no limit
+    int cursor;                        //!< cache slot the page starts at, taken from the nextCursor of the previous page
+    time_t timestamp;                  //!< out: time of the snapshot, to be passed as changedSince by the next poll
+    int nextCursor;                    //!< out: cursor of the next page, -1 if this page is the last one
+    char **unchangedIds;               //!< out: IDs of the matching instances left out for not having changed
+    int unchangedIdsLen;               //!< out: number of entries in unchangedIds
+} ccInstanceQuery;
+
+//! Capacity of a node as counted in the per VM type availability of the resource cache
+typedef struct ccResourceCapacity_t {
+    int availMemory;
+    int availDisk;
+    int availCores;
+    int maxMemory;
+    int maxDisk;
+    int maxCores;
+} ccResourceCapacity;
+
+//! A VM type of the last DescribeResources, with how many instances of it the nodes can run
+typedef struct ccResourceType_t {
+    int mem;
+    int disk;
+    int cores;
+    int avail;                         //!< instances that fit in the capacity the nodes have left
+    int max;                           //!< instances that fit in the whole capacity of the nodes
+} ccResourceType;
+
 typedef struct ccResourceCache_t {
     ccResource resources[MAXNODES];
     int cacheState[MAXNODES];
     int numResources;
     int lastResourceUpdate;
     int resourceCacheUpdate;
+    volatile unsigned int seq;         //!< odd while RESCACHE is held, see get_resourceCacheEntry()
+    ccResourceType types[RESCACHE_MAX_VM_TYPES];    //!< VM types counted, see count_resourceCacheNode()
+    int numTypes;                      //!< number of entries in types
+    boolean typesValid;                //!< types[] adds up counted[] of every node, cleared to have it counted again
+    ccResourceCapacity counted[MAXNODES];   //!< capacity each node contributes to types[], zero if it is stopped
 } ccResourceCache;
 
 typedef struct ccInstanceCache_t {
     ccInstance instances[MAXINSTANCES_PER_CC];
+    ccInstanceSummary summaries[MAXINSTANCES_PER_CC];   //!< hot fields of instances[], kept in sync by the cache functions
     time_t lastseen[MAXINSTANCES_PER_CC];
+    time_t lastchanged[MAXINSTANCES_PER_CC];   //!< when the content of instances[] last changed, for DescribeInstances changedSince
     int cacheState[MAXINSTANCES_PER_CC];
     int numInsts;
     int instanceCacheUpdate;
     int dirty;
+    int index[INSTIDX_LAST][INSTANCE_INDEX_SIZE];  //!< open addressing hash indexes, entries are (slot + 1) and 0 when free
+    int groupHead[INSTGRP_LAST][INSTANCE_GROUP_CHAINS];    //!< first slot of each secondary index chain, (slot + 1) and 0 when empty
+    int groupNext[INSTGRP_LAST][MAXINSTANCES_PER_CC];  //!< next slot in the same chain, (slot + 1) and 0 at the end
+    int groupPrev[INSTGRP_LAST][MAXINSTANCES_PER_CC];  //!< previous slot in the same chain, (slot + 1) and 0 at the head
+    int groupChain[INSTGRP_LAST][MAXINSTANCES_PER_CC]; //!< chain the slot is linked into, (chain + 1) and 0 when not linked
+    int indexed;                       //!< set once the indexes have been built from the cache content
+    long long ckptSeq;                 //!< sequence number of the last change journaled, see checkpoint_journal_slot()
 } ccInstanceCache;
 
 typedef struct ccConfig_t {
@@ -327,12 +533,15 @@ typedef struct ccConfig_t {
     int log_level;
     char log_prefix[64];
     char log_facility[32];
+    char log_async[16];
     char proxyPath[EUCA_MAX_PATH];
     char proxyIp[32];
     int use_proxy;
     int proxy_max_cache_size;
     char configFiles[2][EUCA_MAX_PATH];
     int use_wssec;
+    int use_ncpool;
+    int use_checkpoint;                //!< set to keep a checkpoint of the caches, see checkpoint.h
     int use_tunnels;
     char policyFile[EUCA_MAX_PATH];
     int initialized;
@@ -342,12 +551,21 @@ typedef struct ccConfig_t {
     int schedState;
     int idleThresh;
     int wakeThresh;
+    int consolidateThresh;             //!< POWERSAVE empties nodes using at most this percentage of their cores (0 to disable)
+    double powerArrivalRate;           //!< instances requested per second lately, see sched_power_rate()
+    time_t powerLastArrival;           //!< when powerArrivalRate was last updated
     time_t instanceTimeout;
     time_t ncPollingFrequency;
+    time_t ncPollingMin;               //!< shortest interval between polls of a node with instances in transition, NC_POLLING_MIN
+    time_t ncPollingMax;               //!< longest interval between polls of a stable node, NC_POLLING_MAX
     time_t clcPollingFrequency;
     time_t ncSensorsPollingInterval;
+    int eventPort;                     //!< UDP port on which NCs announce instance changes, the CC_PORT
     int threads[NUM_THREADS];
+    ccMonitorTask monitorTasks[MONITOR_TASK_LAST];  //!< the periodic jobs of the monitor, see monitor_thread()
     int ncFanout;
+    int migrationMaxPerSource;         //!< most migrations the CC lets a source node run at once (0 for no limit)
+    int migrationMaxPerDest;           //!< most migrations the CC lets a destination node receive at once (0 for no limit)
     int ccState;
     int ccLastState;
     int kick_network;
@@ -384,7 +602,7 @@ int doBundleInstance(ncMetadata * pMeta, char *instanceId, char *bucketName, cha
                      char *architecture);
 int doBundleRestartInstance(ncMetadata * pMeta, char *instanceId);
 int doCancelBundleTask(ncMetadata * pMeta, char *instanceId);
-int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char *ncOp, ...);
+int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, ncOpId ncOp, ...);
 int ncGetTimeout(time_t op_start, time_t op_max, int numCalls, int idx);
 int doAttachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *remoteDev, char *localDev);
 int doDetachVolume(ncMetadata * pMeta, char *volumeId, char *instanceId, char *remoteDev, char *localDev, int force);
@@ -394,6 +612,7 @@ int doFlushNetwork(ncMetadata * pMeta, char *accountId, char *destName);
 int doBroadcastNetworkInfo(ncMetadata * pMeta, char *networkInfo);
 int doAssignAddress(ncMetadata * pMeta, char *uuid, char *src, char *dst);
 int doDescribePublicAddresses(ncMetadata * pMeta, publicip ** outAddresses, int *outAddressesLen);
+int doDescribePublicAddressesDelta(ncMetadata * pMeta, u32 since, publicipDelta ** outDeltas, int *outDeltasLen, u32 * outSeq);
 int doUnassignAddress(ncMetadata * pMeta, char *src, char *dst);
 int doStopNetwork(ncMetadata * pMeta, char *accountId, char *netName, int vlan);
 int doDescribeNetworks(ncMetadata * pMeta, char *vmsubdomain, char *nameservers, char **ccs, int ccsLen, vnetConfig * outvnetConfig);
@@ -404,12 +623,13 @@ int refresh_resources(ncMetadata * pMeta, int timeout, int dolock);
 int refresh_instances(ncMetadata * pMeta, int timeout, int dolock);
 int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock);
 int broadcast_network_info(ncMetadata * pMeta, int timeout, int dolock);
-int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstance ** outInsts, int *outInstsLen);
+int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ccInstanceQuery * query, ccInstance ** outInsts, int *outInstsLen);
 int powerUp(ccResource * res);
 int powerDown(ncMetadata * pMeta, ccResource * node);
 void print_netConfig(char *prestr, netConfig * in);
 int ncInstance_to_ccInstance(ccInstance * dst, ncInstance * src);
 int ccInstance_to_ncInstance(ncInstance * dst, ccInstance * src);
+int ccInstance_to_ccInstanceSummary(ccInstanceSummary * dst, ccInstance * src);
 int schedule_instance(virtualMachine * vm, char *amiId, char *kernelId, char *ramdiskId, char *instId, char *userData, char *platform, char *targetNode, int *outresid);
 int schedule_instance_roundrobin(virtualMachine * vm, int *outresid);
 int schedule_instance_explicit(virtualMachine * vm, char *targetNode, int *outresid, boolean is_migration);
@@ -470,10 +690,14 @@ void set_dirty_instanceCache(void);
 int is_clean_instanceCache(void);
 void invalidate_instanceCache(void);
 int refresh_instanceCache(char *instanceId, ccInstance * in);
+int touch_instanceCache(char *instanceId, boolean * transitional);
 int add_instanceCache(char *instanceId, ccInstance * in);
 int del_instanceCacheId(char *instanceId);
 int find_instanceCacheId(char *instanceId, ccInstance ** out);
 int find_instanceCacheIP(char *ip, ccInstance ** out);
+int get_resourceCacheSize(void);
+int get_resourceCacheEntry(int idx, ccResource * out);
+int find_resourceCacheEntry(int (*match) (ccResource *, void *), void *matchParam, ccResource * out, int *outIdx);
 void unlock_exit(int code);
 int sem_mywait(int lockno);
 int sem_mypost(int lockno);
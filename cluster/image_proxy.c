@@ -0,0 +1,780 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/image_proxy.c
+//! Image cache proxy of the CC. With CC_IMAGE_PROXY set, RunInstances hands the nodes
+//! http://CC_IMAGE_PROXY:8776/<id> URLs for the images of an instance instead of object
+//! storage ones, and this module makes those URLs work:
+//!
+//!   * image_proxy_prefetch() starts staging an image into the data directory in the
+//!     background and returns right away. A <id>.lock file, holding the pid of the process
+//!     doing the fetch, makes any other request for the same image a no-op while it is in
+//!     flight, so concurrent misses result in a single download from object storage;
+//!   * image_proxy_start() serves the data directory over HTTP to the nodes of the cluster,
+//!     one thread per download so that a slow node does not hold up the others. Files go
+//!     out with sendfile(), single byte ranges are honored so that a node can resume an
+//!     interrupted download, and a request for an image that is still being fetched waits
+//!     for the fetch rather than failing;
+//!   * image_proxy_evict() keeps the data directory under the configured size, removing
+//!     the images that were least recently served first. Serving an image updates its
+//!     access time explicitly, so this does not depend on how the file system is mounted.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                    // accept4, strcasestr
+#endif /* ! _GNU_SOURCE */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <log.h>
+#include <euca_string.h>
+#include <objectstorage.h>
+
+#include "image_proxy.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define IMAGE_PROXY_REQUEST_MAX                  4096   //!< longest HTTP request read, the rest is ignored
+#define IMAGE_PROXY_BACKLOG                      64
+#define IMAGE_PROXY_LOCK_GRACE_SEC               10     //!< a lock with no pid in it yet is only that young
+#define IMAGE_PROXY_SENDFILE_CHUNK               (1024 * 1024 * 1024)   //!< most bytes asked of one sendfile() call
+
+#define IMAGE_PROXY_MANIFEST_SUFFIX              ".manifest.xml"
+#define IMAGE_PROXY_STAGING_SUFFIX               ".staging"
+#define IMAGE_PROXY_LOCK_SUFFIX                  ".lock"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! An image considered for eviction
+typedef struct imageProxyEntry_t {
+    char name[256];
+    time_t atime;
+    off_t size;
+} imageProxyEntry;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int listen_fd = -1;
+static char proxy_data_dir[EUCA_MAX_PATH] = "";
+static image_proxy_allow_fn proxy_allow = NULL;
+static int proxy_connections = 0;      //!< downloads being served, guarded by proxy_mutex
+static pthread_mutex_t proxy_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static boolean valid_name(const char *name);
+static boolean has_suffix(const char *name, const char *suffix);
+static boolean fetch_in_flight(const char *dataDir, const char *id);
+static int take_fetch_lock(const char *dataDir, const char *id);
+static int fetch_file(const char *dataDir, const char *name, const char *url, boolean byManifest);
+static int compare_entries(const void *a, const void *b);
+static int send_all(int fd, const char *data, size_t len);
+static void send_status(int fd, int status, const char *extra);
+static const char *status_text(int status);
+static boolean parse_range(const char *request, off_t size, off_t * first, off_t * last, boolean * partial);
+static int open_image(const char *name);
+static void serve_request(int fd);
+static void *connection_thread(void *arg);
+static void *listener_thread(void *arg);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Names handed to the proxy are file names in the data directory, never paths
+static boolean valid_name(const char *name)
+{
+    if ((name == NULL) || (name[0] == '\0') || (name[0] == '.') || strchr(name, '/'))
+        return (FALSE);
+    if (strlen(name) >= (256 - strlen(IMAGE_PROXY_MANIFEST_SUFFIX IMAGE_PROXY_STAGING_SUFFIX)))
+        return (FALSE);
+    return (TRUE);
+}
+
+static boolean has_suffix(const char *name, const char *suffix)
+{
+    size_t len = strlen(name);
+    size_t slen = strlen(suffix);
+
+    return ((len >= slen) && !strcmp(name + len - slen, suffix));
+}
+
+//! @returns TRUE if a live process holds the fetch lock of the image
+static boolean fetch_in_flight(const char *dataDir, const char *id)
+{
+    pid_t pid = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char *pidstr = NULL;
+    struct stat mystat = { 0 };
+
+    snprintf(path, sizeof(path), "%s/%s" IMAGE_PROXY_LOCK_SUFFIX, dataDir, id);
+    if (stat(path, &mystat) != 0)
+        return (FALSE);
+
+    if ((pidstr = file2str(path)) != NULL) {
+        pid = atoi(pidstr);
+        EUCA_FREE(pidstr);
+    }
+    // the pid goes in right after the lock is taken
+    if (pid <= 0)
+        return ((time(NULL) - mystat.st_mtime) < IMAGE_PROXY_LOCK_GRACE_SEC);
+    return (check_process(pid, NULL) == 0);
+}
+
+//! Takes the fetch lock of the image, replacing a lock left behind by a fetch that died
+//! @returns the open lock file or -1 if the image is already being fetched (or on error)
+static int take_fetch_lock(const char *dataDir, const char *id)
+{
+    int fd = -1;
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), "%s/%s" IMAGE_PROXY_LOCK_SUFFIX, dataDir, id);
+    if ((fd = open(path, (O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC), 0600)) >= 0)
+        return (fd);
+    if ((errno != EEXIST) || fetch_in_flight(dataDir, id))
+        return (-1);
+
+    LOGDEBUG("removing stale fetch lock %s\n", path);
+    unlink(path);
+    return (open(path, (O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC), 0600));
+}
+
+//! Downloads one file of an image into its staging file, moving it in place once complete
+static int fetch_file(const char *dataDir, const char *name, const char *url, boolean byManifest)
+{
+    int rc = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char finalpath[EUCA_MAX_PATH] = "";
+
+    snprintf(finalpath, sizeof(finalpath), "%s/%s", dataDir, name);
+    if (check_file(finalpath) == 0)
+        return (EUCA_OK);
+
+    snprintf(path, sizeof(path), "%s" IMAGE_PROXY_STAGING_SUFFIX, finalpath);
+    if (byManifest)
+        rc = objectstorage_image_by_manifest_url(url, path, 1);
+    else
+        rc = objectstorage_object_by_url(url, path, 0);
+    if (rc) {
+        unlink(path);
+        return (EUCA_IO_ERROR);
+    }
+    chmod(path, 0600);
+    if (rename(path, finalpath) != 0) {
+        unlink(path);
+        return (EUCA_IO_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Starts staging an image, unless it is already cached or being fetched
+//!
+//! @param[in] dataDir the data directory of the proxy
+//! @param[in] id the identifier of the image, which names its files
+//! @param[in] url the object storage URL of the image manifest
+//!
+//! @return EUCA_OK if the image is cached or on its way, or an error code
+//!
+//! @note the fetch runs in a detached process, so this returns right away
+//!
+int image_proxy_prefetch(const char *dataDir, const char *id, const char *url)
+{
+    int fd = -1;
+    int status = 0;
+    pid_t pid = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char pidstr[32] = "";
+    struct timespec times[2] = { {0, UTIME_NOW}, {0, UTIME_OMIT} };
+
+    if ((dataDir == NULL) || (url == NULL) || !valid_name(id))
+        return (EUCA_INVALID_ERROR);
+
+    snprintf(path, sizeof(path), "%s/%s", dataDir, id);
+    if (check_file(path) == 0) {
+        // about to be served, keep it off the eviction list
+        utimensat(AT_FDCWD, path, times, 0);
+        return (EUCA_OK);
+    }
+
+    if ((fd = take_fetch_lock(dataDir, id)) < 0) {
+        if (fetch_in_flight(dataDir, id)) {
+            LOGDEBUG("image %s is already being fetched\n", id);
+            return (EUCA_OK);
+        }
+        LOGERROR("cannot lock %s/%s for fetching: %s\n", dataDir, id, strerror(errno));
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    // the fetch is double forked so that it outlives the request without leaving a zombie
+    if ((pid = fork()) == 0) {
+        if (fork() == 0) {
+            snprintf(pidstr, sizeof(pidstr), "%d\n", getpid());
+            if (write(fd, pidstr, strlen(pidstr)) < 0)
+                LOGWARN("cannot record fetch of %s in its lock: %s\n", id, strerror(errno));
+            close(fd);
+
+            snprintf(path, sizeof(path), "%s" IMAGE_PROXY_MANIFEST_SUFFIX, id);
+            if (fetch_file(dataDir, path, url, FALSE) != EUCA_OK) {
+                LOGERROR("could not cache image manifest (%s/%s)\n", id, url);
+                status = 1;
+            } else if (fetch_file(dataDir, id, url, TRUE) != EUCA_OK) {
+                LOGERROR("could not cache image (%s/%s)\n", id, url);
+                status = 1;
+            } else {
+                LOGINFO("cached image %s\n", id);
+            }
+            snprintf(path, sizeof(path), "%s/%s" IMAGE_PROXY_LOCK_SUFFIX, dataDir, id);
+            unlink(path);
+            exit(status);
+        }
+        exit(0);
+    }
+    close(fd);
+
+    if (pid < 0) {
+        LOGERROR("cannot start fetch of image %s: %s\n", id, strerror(errno));
+        snprintf(path, sizeof(path), "%s/%s" IMAGE_PROXY_LOCK_SUFFIX, dataDir, id);
+        unlink(path);
+        return (EUCA_THREAD_ERROR);
+    }
+    waitpid(pid, &status, 0);
+    LOGDEBUG("fetching image %s from %s\n", id, url);
+    return (EUCA_OK);
+}
+
+//! Orders the images from the least to the most recently used
+static int compare_entries(const void *a, const void *b)
+{
+    const imageProxyEntry *ea = a;
+    const imageProxyEntry *eb = b;
+
+    if (ea->atime != eb->atime)
+        return ((ea->atime < eb->atime) ? -1 : 1);
+    return (strcmp(ea->name, eb->name));
+}
+
+//!
+//! Removes the least recently used images until the data directory fits in its limit.
+//! Everything in the directory counts against the limit, but only complete images that are
+//! not being fetched are removed, along with their manifests.
+//!
+//! @param[in] dataDir the data directory of the proxy
+//! @param[in] maxMegs the limit, in megabytes
+//!
+//! @return EUCA_OK or an error code
+//!
+int image_proxy_evict(const char *dataDir, long long maxMegs)
+{
+    int i = 0;
+    int num = 0;
+    int size = 0;
+    int evicted = 0;
+    long long total = 0;
+    long long limit = (maxMegs * 1048576LL);
+    char path[EUCA_MAX_PATH] = "";
+    DIR *dir = NULL;
+    struct dirent *dent = NULL;
+    struct stat mystat = { 0 };
+    imageProxyEntry *entries = NULL;
+    imageProxyEntry *grown = NULL;
+
+    if ((dir = opendir(dataDir)) == NULL) {
+        LOGERROR("could not open dir '%s'\n", dataDir);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    while ((dent = readdir(dir)) != NULL) {
+        if (dent->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dataDir, dent->d_name);
+        if ((lstat(path, &mystat) != 0) || !S_ISREG(mystat.st_mode))
+            continue;
+        total += mystat.st_size;
+
+        if (!valid_name(dent->d_name) || has_suffix(dent->d_name, IMAGE_PROXY_MANIFEST_SUFFIX) || has_suffix(dent->d_name, IMAGE_PROXY_STAGING_SUFFIX)
+            || has_suffix(dent->d_name, IMAGE_PROXY_LOCK_SUFFIX) || !strcmp(dent->d_name, "network-topology") || !strcmp(dent->d_name, "config-cc"))
+            continue;
+
+        if (num == size) {
+            size = ((size == 0) ? 64 : (size * 2));
+            if ((grown = EUCA_REALLOC(entries, size, sizeof(imageProxyEntry))) == NULL) {
+                LOGERROR("out of memory!\n");
+                EUCA_FREE(entries);
+                closedir(dir);
+                return (EUCA_MEMORY_ERROR);
+            }
+            entries = grown;
+        }
+        euca_strncpy(entries[num].name, dent->d_name, sizeof(entries[num].name));
+        entries[num].atime = mystat.st_atime;
+        entries[num].size = mystat.st_size;
+        num++;
+    }
+    closedir(dir);
+
+    LOGDEBUG("image cache holds %d image(s) in %lldMB of %lldMB\n", num, (total / 1048576), maxMegs);
+    if (total > limit) {
+        qsort(entries, num, sizeof(imageProxyEntry), compare_entries);
+        for (i = 0; (i < num) && (total > limit); i++) {
+            if (fetch_in_flight(dataDir, entries[i].name))
+                continue;
+            LOGINFO("invalidating cached image %s (%lldMB, last used %lds ago)\n", entries[i].name, ((long long)entries[i].size / 1048576),
+                    (long)(time(NULL) - entries[i].atime));
+            snprintf(path, sizeof(path), "%s/%s", dataDir, entries[i].name);
+            if (unlink(path) == 0)
+                total -= entries[i].size;
+            snprintf(path, sizeof(path), "%s/%s" IMAGE_PROXY_MANIFEST_SUFFIX, dataDir, entries[i].name);
+            if ((stat(path, &mystat) == 0) && (unlink(path) == 0))
+                total -= mystat.st_size;
+            evicted++;
+        }
+        if (total > limit)
+            LOGWARN("image cache is still over its %lldMB limit after invalidating %d image(s)\n", maxMegs, evicted);
+    }
+
+    EUCA_FREE(entries);
+    return (EUCA_OK);
+}
+
+//! Writes all of the data, without raising SIGPIPE if the node went away
+static int send_all(int fd, const char *data, size_t len)
+{
+    ssize_t sent = 0;
+
+    while (len > 0) {
+        if ((sent = send(fd, data, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_ERROR);
+        }
+        data += sent;
+        len -= sent;
+    }
+    return (EUCA_OK);
+}
+
+static const char *status_text(int status)
+{
+    switch (status) {
+    case 200:
+        return ("OK");
+    case 206:
+        return ("Partial Content");
+    case 403:
+        return ("Forbidden");
+    case 404:
+        return ("Not Found");
+    case 405:
+        return ("Method Not Allowed");
+    case 416:
+        return ("Requested Range Not Satisfiable");
+    case 503:
+        return ("Service Unavailable");
+    }
+    return ("Internal Server Error");
+}
+
+//! Answers with a status and no body, with the extra header lines, if any
+static void send_status(int fd, int status, const char *extra)
+{
+    char header[512] = "";
+
+    snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\n%sContent-Length: 0\r\nConnection: close\r\n\r\n", status, status_text(status), ((extra != NULL) ? extra : ""));
+    send_all(fd, header, strlen(header));
+}
+
+//!
+//! Finds the byte range asked for, if any. Only a single range is honored, a request for
+//! several gets the whole file, which HTTP allows.
+//!
+//! @return FALSE if the range cannot be satisfied
+//!
+static boolean parse_range(const char *request, off_t size, off_t * first, off_t * last, boolean * partial)
+{
+    char *range = NULL;
+    char *end = NULL;
+    long long from = 0;
+    long long to = 0;
+
+    *first = 0;
+    *last = (size - 1);
+    *partial = FALSE;
+
+    if (((range = strcasestr(request, "\nRange:")) == NULL) || ((range = strstr(range, "bytes=")) == NULL))
+        return (TRUE);
+    range += strlen("bytes=");
+    if (range[strcspn(range, ",\r\n")] == ',')
+        return (TRUE);
+
+    if (*range == '-') {
+        // the last so many bytes
+        if (((to = strtoll(range + 1, &end, 10)) <= 0) || (end == (range + 1)))
+            return (FALSE);
+        from = ((to >= size) ? 0 : (size - to));
+        to = (size - 1);
+    } else {
+        from = strtoll(range, &end, 10);
+        if ((end == range) || (*end != '-') || (from < 0))
+            return (TRUE);
+        range = end + 1;
+        to = strtoll(range, &end, 10);
+        if (end == range)
+            to = (size - 1);
+        else if (to < from)
+            return (TRUE);
+        if (to >= size)
+            to = (size - 1);
+    }
+
+    if ((size == 0) || (from >= size))
+        return (FALSE);
+    *first = from;
+    *last = to;
+    *partial = TRUE;
+    return (TRUE);
+}
+
+//! Opens a file of the data directory, waiting for it if it is an image being fetched
+//! @returns the open file or -1 if there is no such file
+static int open_image(const char *name)
+{
+    int fd = -1;
+    int waited = 0;
+    char id[256] = "";
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), "%s/%s", proxy_data_dir, name);
+    euca_strncpy(id, name, sizeof(id));
+    if (has_suffix(id, IMAGE_PROXY_MANIFEST_SUFFIX))
+        id[strlen(id) - strlen(IMAGE_PROXY_MANIFEST_SUFFIX)] = '\0';
+
+    // RunInstances hands out the URL as soon as the fetch has started
+    while (((fd = open(path, (O_RDONLY | O_CLOEXEC))) < 0) && (errno == ENOENT) && (waited < IMAGE_PROXY_WAIT_SEC) && fetch_in_flight(proxy_data_dir, id)) {
+        if (waited == 0)
+            LOGDEBUG("waiting for image %s to be fetched\n", id);
+        sleep(1);
+        waited++;
+    }
+    return (fd);
+}
+
+//! Answers one HTTP request: GET or HEAD of a file of the data directory
+static void serve_request(int fd)
+{
+    int file = -1;
+    boolean head = FALSE;
+    boolean partial = FALSE;
+    char request[IMAGE_PROXY_REQUEST_MAX] = "";
+    char header[512] = "";
+    char extra[128] = "";
+    char file_name[256] = "";
+    char *name = NULL;
+    size_t len = 0;
+    ssize_t got = 0;
+    ssize_t sent = 0;
+    off_t first = 0;
+    off_t last = 0;
+    off_t offset = 0;
+    off_t remaining = 0;
+    struct stat mystat = { 0 };
+    struct timeval timeout = { IMAGE_PROXY_IO_TIMEOUT_SEC, 0 };
+    struct timespec times[2] = { {0, UTIME_NOW}, {0, UTIME_OMIT} };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while ((len < (sizeof(request) - 1)) && !strstr(request, "\r\n\r\n") && !strstr(request, "\n\n")) {
+        if ((got = recv(fd, request + len, (sizeof(request) - 1 - len), 0)) <= 0) {
+            if ((got < 0) && (errno == EINTR))
+                continue;
+            break;
+        }
+        len += got;
+        request[len] = '\0';
+    }
+
+    if (!strncmp(request, "GET /", 5)) {
+        name = request + 5;
+    } else if (!strncmp(request, "HEAD /", 6)) {
+        name = request + 6;
+        head = TRUE;
+    } else {
+        send_status(fd, 405, "Allow: GET, HEAD\r\n");
+        return;
+    }
+
+    // the name is cut out of the request line, the headers that follow are still in there
+    len = strcspn(name, " ?\r\n");
+    snprintf(file_name, sizeof(file_name), "%.*s", (int)len, name);
+    if (!valid_name(file_name) || has_suffix(file_name, IMAGE_PROXY_STAGING_SUFFIX) || has_suffix(file_name, IMAGE_PROXY_LOCK_SUFFIX) || ((file = open_image(file_name)) < 0)) {
+        send_status(fd, 404, NULL);
+        return;
+    }
+    if ((fstat(file, &mystat) != 0) || !S_ISREG(mystat.st_mode)) {
+        close(file);
+        send_status(fd, 404, NULL);
+        return;
+    }
+
+    if (!parse_range(name, mystat.st_size, &first, &last, &partial)) {
+        snprintf(extra, sizeof(extra), "Content-Range: bytes */%lld\r\n", (long long)mystat.st_size);
+        send_status(fd, 416, extra);
+        close(file);
+        return;
+    }
+
+    if (partial)
+        snprintf(extra, sizeof(extra), "Content-Range: bytes %lld-%lld/%lld\r\n", (long long)first, (long long)last, (long long)mystat.st_size);
+    snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n%sContent-Length: %lld\r\nConnection: close\r\n\r\n",
+             (partial ? 206 : 200), status_text(partial ? 206 : 200), extra, (long long)((mystat.st_size == 0) ? 0 : (last - first + 1)));
+
+    // what makes the eviction least recently used, whatever the file system does with atime
+    futimens(file, times);
+
+    if ((send_all(fd, header, strlen(header)) == EUCA_OK) && !head && (mystat.st_size > 0)) {
+        offset = first;
+        remaining = (last - first + 1);
+        while (remaining > 0) {
+            if ((sent = sendfile(fd, file, &offset, ((remaining > IMAGE_PROXY_SENDFILE_CHUNK) ? IMAGE_PROXY_SENDFILE_CHUNK : remaining))) <= 0) {
+                if ((sent < 0) && (errno == EINTR))
+                    continue;
+                LOGWARN("download of %s stopped at byte %lld of %lld: %s\n", file_name, (long long)offset, (long long)(last + 1), ((sent < 0) ? strerror(errno) : "end of file"));
+                break;
+            }
+            remaining -= sent;
+        }
+    }
+    close(file);
+}
+
+//! Serves one download, then gives its place to the next one
+static void *connection_thread(void *arg)
+{
+    int fd = (int)((intptr_t) arg);
+
+    serve_request(fd);
+    close(fd);
+
+    pthread_mutex_lock(&proxy_mutex);
+    proxy_connections--;
+    pthread_mutex_unlock(&proxy_mutex);
+    return (NULL);
+}
+
+//! Accepts the downloads from the allowed nodes, each in its own thread
+static void *listener_thread(void *arg)
+{
+    int fd = -1;
+    int listener = (int)((intptr_t) arg);
+    boolean busy = FALSE;
+    char ip[INET_ADDRSTRLEN] = "";
+    socklen_t addrlen = 0;
+    struct sockaddr_in addr = { 0 };
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        addrlen = sizeof(addr);
+        if ((fd = accept4(listener, ((struct sockaddr *)&addr), &addrlen, SOCK_CLOEXEC)) < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EMFILE) || (errno == ENFILE))
+                continue;
+            break;
+        }
+
+        if (!inet_ntop(AF_INET, &(addr.sin_addr), ip, sizeof(ip)) || ((proxy_allow != NULL) && !proxy_allow(ip))) {
+            LOGDEBUG("refusing image download from %s, not a node of this cluster\n", ip);
+            send_status(fd, 403, NULL);
+            close(fd);
+            continue;
+        }
+
+        pthread_mutex_lock(&proxy_mutex);
+        if ((busy = (proxy_connections >= IMAGE_PROXY_MAX_CONNECTIONS)) == FALSE)
+            proxy_connections++;
+        pthread_mutex_unlock(&proxy_mutex);
+        if (busy) {
+            LOGWARN("refusing image download from %s, %d already in progress\n", ip, IMAGE_PROXY_MAX_CONNECTIONS);
+            send_status(fd, 503, "Retry-After: 10\r\n");
+            close(fd);
+            continue;
+        }
+
+        if (pthread_create(&thread, &attr, connection_thread, ((void *)((intptr_t) fd))) != 0) {
+            LOGERROR("cannot start a thread for the image download from %s\n", ip);
+            send_status(fd, 503, "Retry-After: 10\r\n");
+            close(fd);
+            pthread_mutex_lock(&proxy_mutex);
+            proxy_connections--;
+            pthread_mutex_unlock(&proxy_mutex);
+        }
+    }
+    pthread_attr_destroy(&attr);
+    LOGERROR("image proxy listener exiting: %s\n", strerror(errno));
+    return (NULL);
+}
+
+//!
+//! Starts serving the data directory, unless this process already does
+//!
+//! @param[in] port the TCP port to listen on
+//! @param[in] dataDir the data directory of the proxy
+//! @param[in] allow tells which addresses may download, NULL for any
+//!
+//! @return EUCA_OK or an error code
+//!
+//! @note the downloads are served by threads of the calling process, so it must stay around
+//!
+int image_proxy_start(int port, const char *dataDir, image_proxy_allow_fn allow)
+{
+    int one = 1;
+    int fd = -1;
+    pthread_t thread;
+    struct sockaddr_in addr = { 0 };
+
+    if (listen_fd >= 0)
+        return (EUCA_OK);
+    if ((dataDir == NULL) || (port <= 0))
+        return (EUCA_INVALID_ERROR);
+
+    euca_strncpy(proxy_data_dir, dataDir, sizeof(proxy_data_dir));
+    proxy_allow = allow;
+
+    if ((fd = socket(AF_INET, (SOCK_STREAM | SOCK_CLOEXEC), 0)) < 0) {
+        LOGERROR("cannot create image proxy socket: %s\n", strerror(errno));
+        return (EUCA_ERROR);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if ((bind(fd, ((struct sockaddr *)&addr), sizeof(addr)) != 0) || (listen(fd, IMAGE_PROXY_BACKLOG) != 0)) {
+        LOGERROR("cannot listen for image downloads on port %d: %s\n", port, strerror(errno));
+        close(fd);
+        return (EUCA_ERROR);
+    }
+
+    if (pthread_create(&thread, NULL, listener_thread, ((void *)((intptr_t) fd))) != 0) {
+        LOGERROR("cannot start the image proxy listener thread\n");
+        close(fd);
+        return (EUCA_THREAD_ERROR);
+    }
+    pthread_detach(thread);
+
+    listen_fd = fd;
+    LOGINFO("serving cached images from %s on port %d\n", proxy_data_dir, port);
+    return (EUCA_OK);
+}
+
+//! @returns TRUE if this process serves the data directory
+boolean image_proxy_running(void)
+{
+    return (listen_fd >= 0);
+}
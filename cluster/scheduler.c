@@ -0,0 +1,756 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file cluster/scheduler.c
+//! Scoring instance scheduler. The resource cache is snapshotted into a
+//! capacity index bucketed by free cores, so that a placement only looks at
+//! the nodes that can possibly hold the VM, and reservations made while
+//! placing a whole RunInstances request move nodes between buckets instead
+//! of rescanning the cache for every instance.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <semaphore.h>
+
+#include <eucalyptus.h>
+#include <handlers.h>
+#include <log.h>
+#include "data.h"
+
+#include <scheduler.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+extern ccConfig *config;
+extern ccResourceCache *resourceCache;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int sched_bucket(int cores);
+static void sched_index_link(schedIndex * idx, int resid);
+static void sched_index_unlink(schedIndex * idx, int resid);
+static boolean sched_index_fits(const schedIndex * idx, int resid, const virtualMachine * vm);
+static long long sched_score_pack(const schedIndex * idx, int resid, const virtualMachine * vm);
+static long long sched_score_spread(const schedIndex * idx, int resid, const virtualMachine * vm);
+static int sched_plan(virtualMachine * vm, int count, int *outresids, boolean arrivals);
+static void sched_power_note_arrivals(int count, time_t now);
+static int sched_power_prewake(schedIndex * idx, const schedScorer * scorer, virtualMachine * vm, const int *resids, int placed, int expected);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Scheduling policies served by the capacity index. GREEDY, ROUNDROBIN and USER keep their own implementations in handlers.c
+static const schedScorer sched_scorers[] = {
+    {SCHEDPOWERSAVE, SCHED_SCAN_UP, sched_score_pack},  // awake nodes first, packed tightly so idle ones can stay asleep
+    {SCHEDBINPACK, SCHED_SCAN_UP, sched_score_pack},
+    {SCHEDSPREAD, SCHED_SCAN_DOWN, sched_score_spread},
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Maps a free core count to its bucket in the capacity index
+//!
+//! @param[in] cores number of free cores
+//!
+//! @return the bucket index
+//!
+static int sched_bucket(int cores)
+{
+    if (cores < 0)
+        return (0);
+    if (cores >= SCHED_CORE_BUCKETS)
+        return (SCHED_CORE_BUCKETS - 1);
+    return (cores);
+}
+
+//!
+//! Links a resource at the head of the bucket matching its free cores
+//!
+//! @param[in] idx   pointer to the capacity index
+//! @param[in] resid index of the resource in the resource cache
+//!
+static void sched_index_link(schedIndex * idx, int resid)
+{
+    int b = sched_bucket(idx->availCores[resid]);
+    int t = idx->tier[resid];
+
+    idx->bucket[resid] = b;
+    idx->prev[resid] = -1;
+    idx->next[resid] = idx->head[t][b];
+    if (idx->head[t][b] >= 0)
+        idx->prev[idx->head[t][b]] = resid;
+    idx->head[t][b] = resid;
+}
+
+//!
+//! Removes a resource from its current bucket
+//!
+//! @param[in] idx   pointer to the capacity index
+//! @param[in] resid index of the resource in the resource cache
+//!
+static void sched_index_unlink(schedIndex * idx, int resid)
+{
+    int t = idx->tier[resid];
+
+    if (idx->prev[resid] >= 0)
+        idx->next[idx->prev[resid]] = idx->next[resid];
+    else
+        idx->head[t][idx->bucket[resid]] = idx->next[resid];
+    if (idx->next[resid] >= 0)
+        idx->prev[idx->next[resid]] = idx->prev[resid];
+    idx->next[resid] = idx->prev[resid] = -1;
+}
+
+//!
+//! Checks whether the capacity left on a resource can hold a VM
+//!
+//! @param[in] idx   pointer to the capacity index
+//! @param[in] resid index of the resource in the resource cache
+//! @param[in] vm    the VM type to place
+//!
+//! @return TRUE if the VM fits, FALSE otherwise
+//!
+static boolean sched_index_fits(const schedIndex * idx, int resid, const virtualMachine * vm)
+{
+    if ((idx->availMemory[resid] - vm->mem) < 0)
+        return (FALSE);
+    if ((idx->availDisk[resid] - vm->disk) < 0)
+        return (FALSE);
+    if ((idx->availCores[resid] - vm->cores) < 0)
+        return (FALSE);
+    return (TRUE);
+}
+
+//!
+//! Bin-packing score: the fewer cores (then memory) left over, the better
+//!
+//! @param[in] idx   pointer to the capacity index
+//! @param[in] resid index of the resource in the resource cache
+//! @param[in] vm    the VM type to place
+//!
+//! @return the score of the resource
+//!
+static long long sched_score_pack(const schedIndex * idx, int resid, const virtualMachine * vm)
+{
+    long long cores = idx->availCores[resid] - vm->cores;
+    long long mem = idx->availMemory[resid] - vm->mem;
+
+    return (-((cores << 31) + mem));
+}
+
+//!
+//! Spreading score: the more cores (then memory) left over, the better
+//!
+//! @param[in] idx   pointer to the capacity index
+//! @param[in] resid index of the resource in the resource cache
+//! @param[in] vm    the VM type to place
+//!
+//! @return the score of the resource
+//!
+static long long sched_score_spread(const schedIndex * idx, int resid, const virtualMachine * vm)
+{
+    return (-sched_score_pack(idx, resid, vm));
+}
+
+//!
+//! Looks up the scorer implementing a scheduling policy
+//!
+//! @param[in] policy one of the SCHED* policies
+//!
+//! @return a pointer to the scorer or NULL if the policy is not served by the capacity index
+//!
+const schedScorer *sched_get_scorer(int policy)
+{
+    int i = 0;
+
+    for (i = 0; i < (sizeof(sched_scorers) / sizeof(schedScorer)); i++) {
+        if (sched_scorers[i].policy == policy)
+            return (&sched_scorers[i]);
+    }
+    return (NULL);
+}
+
+//!
+//! Builds the capacity index from the current content of a resource cache
+//!
+//! @param[out] idx   pointer to the capacity index to fill
+//! @param[in]  cache pointer to the resource cache to snapshot
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if any parameter is invalid
+//!
+//! @pre The caller must hold the RESCACHE lock
+//!
+int sched_index_build(schedIndex * idx, ccResourceCache * cache)
+{
+    int i = 0;
+    int t = 0;
+    int b = 0;
+    ccResource *res = NULL;
+
+    if (!idx || !cache)
+        return (EUCA_INVALID_ERROR);
+
+    for (t = 0; t < SCHED_TIER_LAST; t++) {
+        for (b = 0; b < SCHED_CORE_BUCKETS; b++) {
+            idx->head[t][b] = -1;
+        }
+    }
+
+    idx->numResources = cache->numResources;
+    for (i = idx->numResources - 1; i >= 0; i--) {
+        res = &(cache->resources[i]);
+        idx->availMemory[i] = res->availMemory;
+        idx->availDisk[i] = res->availDisk;
+        idx->availCores[i] = res->availCores;
+        idx->next[i] = idx->prev[i] = -1;
+        idx->bucket[i] = sched_bucket(res->availCores);
+
+        if (res->ncState != ENABLED) {
+            idx->tier[i] = SCHED_TIER_NONE;
+        } else if ((res->state == RESUP) || (res->state == RESWAKING)) {
+            idx->tier[i] = SCHED_TIER_AWAKE;
+        } else if (res->state == RESASLEEP) {
+            idx->tier[i] = SCHED_TIER_ASLEEP;
+        } else {
+            idx->tier[i] = SCHED_TIER_NONE;
+        }
+
+        if (idx->tier[i] != SCHED_TIER_NONE)
+            sched_index_link(idx, i);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Picks the best resource for a VM. Awake resources always win over
+//! sleeping ones; within a tier only the buckets with enough free cores
+//! are visited, in the order the scorer asks for.
+//!
+//! @param[in] idx    pointer to the capacity index
+//! @param[in] scorer the policy used to rank candidates
+//! @param[in] vm     the VM type to place
+//!
+//! @return the index of the chosen resource or -1 if none can hold the VM
+//!
+int sched_index_pick(schedIndex * idx, const schedScorer * scorer, const virtualMachine * vm)
+{
+    int t = 0;
+    int b = 0;
+    int n = 0;
+    int lo = 0;
+    int step = 0;
+    int best = -1;
+    long long score = 0;
+    long long bestScore = 0;
+
+    lo = sched_bucket(vm->cores);
+    step = ((scorer->scan == SCHED_SCAN_DOWN) ? -1 : 1);
+
+    for (t = 0; (t < SCHED_TIER_LAST) && (best < 0); t++) {
+        for (b = ((step > 0) ? lo : (SCHED_CORE_BUCKETS - 1)); (b >= lo) && (b < SCHED_CORE_BUCKETS); b += step) {
+            for (n = idx->head[t][b]; n >= 0; n = idx->next[n]) {
+                if (!sched_index_fits(idx, n, vm))
+                    continue;
+                score = scorer->score(idx, n, vm);
+                if ((best < 0) || (score > bestScore) || ((score == bestScore) && (n < best))) {
+                    best = n;
+                    bestScore = score;
+                }
+            }
+
+            if ((best >= 0) && (scorer->scan != SCHED_SCAN_ALL))
+                break;
+        }
+    }
+    return (best);
+}
+
+//!
+//! Reserves the capacity of a VM on a resource and moves it to its new bucket
+//!
+//! @param[in] idx   pointer to the capacity index
+//! @param[in] resid index of the resource in the resource cache
+//! @param[in] vm    the VM type being placed
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if any parameter is invalid
+//!
+int sched_index_reserve(schedIndex * idx, int resid, const virtualMachine * vm)
+{
+    if (!idx || !vm || (resid < 0) || (resid >= idx->numResources) || (idx->tier[resid] == SCHED_TIER_NONE))
+        return (EUCA_INVALID_ERROR);
+
+    sched_index_unlink(idx, resid);
+    idx->availMemory[resid] -= vm->mem;
+    idx->availDisk[resid] -= vm->disk;
+    idx->availCores[resid] -= vm->cores;
+    sched_index_link(idx, resid);
+    return (EUCA_OK);
+}
+
+//!
+//! Schedules a single instance using the scorer of the configured policy
+//!
+//! @param[in]  vm       the VM type to place
+//! @param[out] outresid index of the chosen resource
+//!
+//! @return 0 on success, 1 if no resource can hold the VM or the policy has no scorer
+//!
+//! @pre The caller must hold the RESCACHE and CONFIG locks
+//!
+int schedule_instance_scored(virtualMachine * vm, int *outresid)
+{
+    int ret = 0;
+
+    *outresid = 0;
+    if ((ret = sched_plan(vm, 1, outresid, FALSE)) != 1)
+        return (1);
+    return (schedule_instance_planned(vm, *outresid));
+}
+
+//!
+//! Places a whole reservation in one pass. The capacity index is built once
+//! and every placement reserves its capacity in it, so that the following
+//! instances see what is left. Nothing is written to the resource cache; the
+//! caller confirms each placement with schedule_instance_planned() when it
+//! actually runs the instance.
+//!
+//! @param[in]  vm        the VM type to place
+//! @param[in]  count     number of instances in the reservation
+//! @param[out] outresids resource chosen for each instance, -1 past the returned count
+//!
+//! @return the number of instances placed or -1 if the configured policy has no scorer
+//!
+//! @pre The caller must hold the RESCACHE and CONFIG locks
+//!
+int schedule_instance_batch(virtualMachine * vm, int count, int *outresids)
+{
+    return (sched_plan(vm, count, outresids, TRUE));
+}
+
+//!
+//! Does the work of schedule_instance_batch(). Under POWERSAVE, a new
+//! reservation (as opposed to a retry of one of its instances) also wakes
+//! every sleeping node it was placed on at once, along with the nodes the
+//! instances expected to arrive while those wake up will need.
+//!
+//! @param[in]  vm        the VM type to place
+//! @param[in]  count     number of instances in the reservation
+//! @param[out] outresids resource chosen for each instance, -1 past the returned count
+//! @param[in]  arrivals  set if the instances are new arrivals rather than retries
+//!
+//! @return the number of instances placed or -1 if the configured policy has no scorer
+//!
+//! @pre The caller must hold the RESCACHE and CONFIG locks
+//!
+static int sched_plan(virtualMachine * vm, int count, int *outresids, boolean arrivals)
+{
+    int i = 0;
+    int placed = 0;
+    int expected = 0;
+    time_t now = time(NULL);
+    schedIndex *idx = NULL;
+    const schedScorer *scorer = NULL;
+
+    if ((scorer = sched_get_scorer(config->schedPolicy)) == NULL)
+        return (-1);
+
+    for (i = 0; i < count; i++)
+        outresids[i] = -1;
+
+    if ((idx = EUCA_ZALLOC(1, sizeof(schedIndex))) == NULL) {
+        LOGERROR("out of memory allocating scheduler capacity index\n");
+        return (0);
+    }
+
+    LOGDEBUG("scheduler using %s policy to place %d instance(s)\n", SCHEDPOLICIES[config->schedPolicy], count);
+    sched_index_build(idx, resourceCache);
+    for (placed = 0; placed < count; placed++) {
+        if ((outresids[placed] = sched_index_pick(idx, scorer, vm)) < 0)
+            break;
+        sched_index_reserve(idx, outresids[placed], vm);
+    }
+
+    if (arrivals && (config->schedPolicy == SCHEDPOWERSAVE)) {
+        // what is expected to arrive while the nodes wake up, not counting this request
+        expected = (int)((sched_power_rate(now) * config->wakeThresh) + 0.5);
+        sched_power_note_arrivals(count, now);
+        sched_power_prewake(idx, scorer, vm, outresids, placed, expected);
+    }
+
+    EUCA_FREE(idx);
+    return (placed);
+}
+
+//!
+//! Confirms a placement made by schedule_instance_batch() against the live
+//! resource cache, which may have changed since, and wakes the node up if
+//! it was asleep.
+//!
+//! @param[in] vm    the VM type to place
+//! @param[in] resid index of the planned resource
+//!
+//! @return 0 if the instance can still go to this resource, 1 otherwise
+//!
+//! @pre The caller must hold the RESCACHE lock
+//!
+int schedule_instance_planned(virtualMachine * vm, int resid)
+{
+    ccResource *res = NULL;
+
+    if ((resid < 0) || (resid >= resourceCache->numResources))
+        return (1);
+
+    res = &(resourceCache->resources[resid]);
+    if ((res->ncState != ENABLED) || ((res->state != RESUP) && (res->state != RESWAKING) && (res->state != RESASLEEP)))
+        return (1);
+
+    if (((res->availMemory - vm->mem) < 0) || ((res->availDisk - vm->disk) < 0) || ((res->availCores - vm->cores) < 0))
+        return (1);
+
+    if (res->state == RESASLEEP) {
+        powerUp(res);
+    }
+    return (0);
+}
+
+//!
+//! Estimates the rate at which instances have been requested lately. The
+//! estimate decays linearly back to zero over SCHED_POWER_RATE_WINDOW
+//! seconds without requests.
+//!
+//! @param[in] now the current time
+//!
+//! @return the number of instances requested per second
+//!
+//! @pre The caller must hold the CONFIG lock
+//!
+double sched_power_rate(time_t now)
+{
+    time_t elapsed = now - config->powerLastArrival;
+
+    if ((elapsed < 0) || (elapsed >= SCHED_POWER_RATE_WINDOW))
+        return (0.0);
+    return (config->powerArrivalRate * (SCHED_POWER_RATE_WINDOW - elapsed) / SCHED_POWER_RATE_WINDOW);
+}
+
+//!
+//! Accounts for a request in the POWERSAVE arrival rate
+//!
+//! @param[in] count number of instances requested
+//! @param[in] now   the current time
+//!
+//! @pre The caller must hold the CONFIG lock
+//!
+static void sched_power_note_arrivals(int count, time_t now)
+{
+    config->powerArrivalRate = sched_power_rate(now) + ((double)count / SCHED_POWER_RATE_WINDOW);
+    config->powerLastArrival = now;
+}
+
+//!
+//! Wakes all the sleeping nodes of a plan at once, instead of one at a time
+//! as the instances get dispatched, then keeps placing the expected arrivals
+//! in the capacity index and wakes the sleeping nodes these land on, up to
+//! SCHED_POWER_MAX_PREWAKE of them.
+//!
+//! @param[in] idx      the capacity index, with the reservations of the plan
+//! @param[in] scorer   the POWERSAVE scorer
+//! @param[in] vm       the VM type of the request, also used for the expected arrivals
+//! @param[in] resids   resource chosen for each instance of the plan
+//! @param[in] placed   number of instances in the plan
+//! @param[in] expected number of further instances expected while the nodes wake up
+//!
+//! @return the number of nodes woken up
+//!
+//! @pre The caller must hold the RESCACHE and CONFIG locks
+//!
+static int sched_power_prewake(schedIndex * idx, const schedScorer * scorer, virtualMachine * vm, const int *resids, int placed, int expected)
+{
+    int i = 0;
+    int resid = 0;
+    int woken = 0;
+    int ahead = 0;
+    boolean tried[MAXNODES] = { FALSE };
+    ccResource *res = NULL;
+
+    for (i = 0; i < placed; i++) {
+        res = &(resourceCache->resources[resids[i]]);
+        if ((res->state == RESASLEEP) && !tried[resids[i]]) {
+            tried[resids[i]] = TRUE;
+            if (powerUp(res) == EUCA_OK)
+                woken++;
+        }
+    }
+
+    for (i = 0; (i < expected) && (ahead < SCHED_POWER_MAX_PREWAKE); i++) {
+        if ((resid = sched_index_pick(idx, scorer, vm)) < 0)
+            break;
+        sched_index_reserve(idx, resid, vm);
+
+        res = &(resourceCache->resources[resid]);
+        if ((res->state == RESASLEEP) && !tried[resid]) {
+            tried[resid] = TRUE;
+            LOGINFO("waking up %s ahead of the %d instance(s) expected in the next %d seconds\n", res->hostname, expected, config->wakeThresh);
+            if (powerUp(res) == EUCA_OK)
+                ahead++;
+        }
+    }
+
+    if (woken + ahead)
+        LOGDEBUG("woke up %d node(s) for %d planned instance(s) and %d node(s) ahead of demand\n", woken, placed, ahead);
+    return (woken + ahead);
+}
+
+//!
+//! Looks for a lightly loaded node whose instances all fit on the other awake
+//! nodes, so that it can be emptied by migration and then powered down once
+//! idle. Only nodes running at most config->consolidateThresh percent of their
+//! cores are considered, least loaded first, and nothing is planned while an
+//! instance is migrating or while the recent arrival rate says the capacity
+//! will be needed again before the node would be asleep.
+//!
+//! @param[in]  insts    the instances of the cluster
+//! @param[in]  numInsts number of entries in insts
+//! @param[out] outsrc   the node to empty, -1 if none
+//! @param[out] outdsts  the distinct destinations, at least MAXNODES entries
+//!
+//! @return the number of destinations in outdsts, 0 if there is nothing to consolidate
+//!
+//! @pre The caller must hold the RESCACHE and CONFIG locks
+//!
+int sched_power_consolidate(const schedInstance * insts, int numInsts, int *outsrc, int *outdsts)
+{
+    int i = 0;
+    int src = 0;
+    int resid = 0;
+    int ndst = 0;
+    int numInstsOn[MAXNODES] = { 0 };
+    int usedCores[MAXNODES] = { 0 };
+    boolean tried[MAXNODES] = { FALSE };
+    boolean isdst[MAXNODES] = { FALSE };
+    boolean fits = FALSE;
+    ccResource *res = NULL;
+    schedIndex *idx = NULL;
+    schedIndex *scratch = NULL;
+    virtualMachine *vm = NULL;
+    const schedScorer *scorer = NULL;
+
+    *outsrc = -1;
+    if ((config->schedPolicy != SCHEDPOWERSAVE) || (config->consolidateThresh <= 0))
+        return (0);
+
+    if ((sched_power_rate(time(NULL)) * config->idleThresh) >= 1.0) {
+        LOGDEBUG("not consolidating nodes, instances are still arriving\n");
+        return (0);
+    }
+
+    for (i = 0; i < numInsts; i++) {
+        if (insts[i].migrating)
+            return (0);
+        if ((insts[i].resid >= 0) && (insts[i].resid < resourceCache->numResources)) {
+            numInstsOn[insts[i].resid]++;
+            usedCores[insts[i].resid] += insts[i].cores;
+        }
+    }
+
+    scorer = sched_get_scorer(SCHEDPOWERSAVE);
+    idx = EUCA_ZALLOC(1, sizeof(schedIndex));
+    scratch = EUCA_ZALLOC(1, sizeof(schedIndex));
+    vm = EUCA_ZALLOC(1, sizeof(virtualMachine));
+    if (!idx || !scratch || !vm) {
+        LOGERROR("out of memory planning node consolidation\n");
+        EUCA_FREE(idx);
+        EUCA_FREE(scratch);
+        EUCA_FREE(vm);
+        return (0);
+    }
+
+    // only nodes that are up and can take migrations may receive the instances
+    sched_index_build(idx, resourceCache);
+    for (i = 0; i < idx->numResources; i++) {
+        res = &(resourceCache->resources[i]);
+        if ((idx->tier[i] != SCHED_TIER_NONE) && ((res->state != RESUP) || !res->migrationCapable)) {
+            sched_index_unlink(idx, i);
+            idx->tier[i] = SCHED_TIER_NONE;
+        }
+    }
+
+    while (!fits) {
+        // least loaded candidate not tried yet
+        src = -1;
+        for (i = 0; i < idx->numResources; i++) {
+            res = &(resourceCache->resources[i]);
+            if (tried[i] || (idx->tier[i] != SCHED_TIER_AWAKE) || (res->state != RESUP) || !numInstsOn[i] || (res->maxCores <= 0))
+                continue;
+            if ((usedCores[i] * 100) > (res->maxCores * config->consolidateThresh))
+                continue;
+            if ((src < 0) || (usedCores[i] < usedCores[src]))
+                src = i;
+        }
+        if (src < 0)
+            break;
+        tried[src] = TRUE;
+
+        memcpy(scratch, idx, sizeof(schedIndex));
+        sched_index_unlink(scratch, src);
+        scratch->tier[src] = SCHED_TIER_NONE;
+
+        bzero(isdst, sizeof(isdst));
+        ndst = 0;
+        fits = TRUE;
+        for (i = 0; (i < numInsts) && fits; i++) {
+            if (insts[i].resid != src)
+                continue;
+            vm->mem = insts[i].mem;
+            vm->disk = insts[i].disk;
+            vm->cores = insts[i].cores;
+            if ((resid = sched_index_pick(scratch, scorer, vm)) < 0) {
+                fits = FALSE;
+            } else {
+                sched_index_reserve(scratch, resid, vm);
+                if (!isdst[resid]) {
+                    isdst[resid] = TRUE;
+                    outdsts[ndst++] = resid;
+                }
+            }
+        }
+    }
+
+    if (fits) {
+        *outsrc = src;
+        LOGINFO("node %s runs %d instance(s) on %d/%d cores, consolidating them onto %d other node(s)\n", resourceCache->resources[src].hostname, numInstsOn[src],
+                usedCores[src], resourceCache->resources[src].maxCores, ndst);
+    } else {
+        ndst = 0;
+    }
+
+    EUCA_FREE(idx);
+    EUCA_FREE(scratch);
+    EUCA_FREE(vm);
+    return (ndst);
+}
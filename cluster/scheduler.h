@@ -0,0 +1,201 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_SCHEDULER_H_
+#define _INCLUDE_SCHEDULER_H_
+
+//!
+//! @file cluster/scheduler.h
+//! Scoring instance scheduler backed by a free-capacity index over the resource cache
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <eucalyptus.h>
+#include <data.h>
+#include <handlers.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define SCHED_CORE_BUCKETS                        64    //!< Number of free-core buckets in the capacity index (the last one holds everything above)
+#define SCHED_POWER_RATE_WINDOW                   600   //!< seconds over which the POWERSAVE arrival rate is averaged
+#define SCHED_POWER_MAX_PREWAKE                   8     //!< most nodes POWERSAVE wakes ahead of the instances asking for them
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Order in which a scorer wants the free-core buckets visited
+enum {
+    SCHED_SCAN_ALL,                    //!< visit every bucket, the score alone decides
+    SCHED_SCAN_UP,                     //!< fewest free cores first, stop at the first bucket with a fit
+    SCHED_SCAN_DOWN,                   //!< most free cores first, stop at the first bucket with a fit
+};
+
+//! Node tiers, awake nodes are always preferred over sleeping ones
+enum {
+    SCHED_TIER_AWAKE,
+    SCHED_TIER_ASLEEP,
+    SCHED_TIER_LAST,
+    SCHED_TIER_NONE = SCHED_TIER_LAST,
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Free capacity snapshot of the resource cache, bucketed by free cores
+typedef struct schedIndex_t {
+    int numResources;                  //!< number of resources indexed
+    int head[SCHED_TIER_LAST][SCHED_CORE_BUCKETS];  //!< first resource of each bucket, -1 if empty
+    int next[MAXNODES];                //!< next resource in the same bucket, -1 at the end
+    int prev[MAXNODES];                //!< previous resource in the same bucket, -1 at the head
+    int bucket[MAXNODES];              //!< bucket the resource is currently linked into
+    int tier[MAXNODES];                //!< tier of the resource, SCHED_TIER_NONE if not schedulable
+    int availMemory[MAXNODES];         //!< free memory left after the reservations made so far
+    int availDisk[MAXNODES];           //!< free disk left after the reservations made so far
+    int availCores[MAXNODES];          //!< free cores left after the reservations made so far
+} schedIndex;
+
+//! A scoring function; higher scores win, ties go to the lowest resource index
+typedef long long (*schedScoreFn) (const schedIndex * idx, int resid, const virtualMachine * vm);
+
+//! What the consolidation planner needs to know about an instance
+typedef struct schedInstance_t {
+    int resid;                         //!< resource the instance runs on
+    int mem;                           //!< memory of the instance
+    int disk;                          //!< disk of the instance
+    int cores;                         //!< cores of the instance
+    boolean migrating;                 //!< set if the instance is being migrated
+} schedInstance;
+
+//! A pluggable scheduling policy
+typedef struct schedScorer_t {
+    int policy;                        //!< SCHED* policy this scorer implements
+    int scan;                          //!< SCHED_SCAN_* bucket visiting order
+    schedScoreFn score;                //!< scoring function
+} schedScorer;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+const schedScorer *sched_get_scorer(int policy);
+int sched_index_build(schedIndex * idx, ccResourceCache * cache);
+int sched_index_pick(schedIndex * idx, const schedScorer * scorer, const virtualMachine * vm);
+int sched_index_reserve(schedIndex * idx, int resid, const virtualMachine * vm);
+
+int schedule_instance_scored(virtualMachine * vm, int *outresid);
+int schedule_instance_batch(virtualMachine * vm, int count, int *outresids);
+int schedule_instance_planned(virtualMachine * vm, int resid);
+
+double sched_power_rate(time_t now);
+int sched_power_consolidate(const schedInstance * insts, int numInsts, int *outsrc, int *outdsts);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_SCHEDULER_H_ */
@@ -177,7 +177,7 @@ adb_DescribeServicesResponse_t *DescribeServicesMarshal(adb_DescribeServices_t *
     int serviceIdsLen = 0;
     serviceStatusType *outStatuses = NULL;
     int outStatusesLen = 0;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     adbinput = adb_DescribeServices_get_DescribeServices(describeServices, env);
     adbresp = adb_describeServicesResponseType_create(env);
@@ -228,7 +228,7 @@ adb_DescribeServicesResponse_t *DescribeServicesMarshal(adb_DescribeServices_t *
     ret = adb_DescribeServicesResponse_create(env);
     adb_DescribeServicesResponse_set_DescribeServicesResponse(ret, env, adbresp);
 
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     int stats_ret = 0;
     stats_ret = cached_message_stats_update("DescribeServices", (long)call_time, rc);
     if(stats_ret != EUCA_OK) {
@@ -260,7 +260,7 @@ adb_StartServiceResponse_t *StartServiceMarshal(adb_StartService_t * startServic
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256];
     ncMetadata ccMeta;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     adbinput = adb_StartService_get_StartService(startService, env);
     adbresp = adb_startServiceResponseType_create(env);
@@ -300,7 +300,7 @@ adb_StartServiceResponse_t *StartServiceMarshal(adb_StartService_t * startServic
     adb_StartServiceResponse_set_StartServiceResponse(ret, env, adbresp);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("StartService", (long)call_time, rc);
 
     return (ret);
@@ -328,7 +328,7 @@ adb_StopServiceResponse_t *StopServiceMarshal(adb_StopService_t * stopService, c
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256];
     ncMetadata ccMeta;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     adbinput = adb_StopService_get_StopService(stopService, env);
     adbresp = adb_stopServiceResponseType_create(env);
@@ -368,7 +368,7 @@ adb_StopServiceResponse_t *StopServiceMarshal(adb_StopService_t * stopService, c
     adb_StopServiceResponse_set_StopServiceResponse(ret, env, adbresp);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("StopService", (long)call_time, rc);
 
     return (ret);
@@ -396,7 +396,7 @@ adb_EnableServiceResponse_t *EnableServiceMarshal(adb_EnableService_t * enableSe
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256];
     ncMetadata ccMeta;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     adbinput = adb_EnableService_get_EnableService(enableService, env);
     adbresp = adb_enableServiceResponseType_create(env);
@@ -436,7 +436,7 @@ adb_EnableServiceResponse_t *EnableServiceMarshal(adb_EnableService_t * enableSe
     adb_EnableServiceResponse_set_EnableServiceResponse(ret, env, adbresp);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("EnableService", (long)call_time, rc);
 
     return (ret);
@@ -464,7 +464,7 @@ adb_DisableServiceResponse_t *DisableServiceMarshal(adb_DisableService_t * disab
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256];
     ncMetadata ccMeta;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     adbinput = adb_DisableService_get_DisableService(disableService, env);
     adbresp = adb_disableServiceResponseType_create(env);
@@ -504,7 +504,7 @@ adb_DisableServiceResponse_t *DisableServiceMarshal(adb_DisableService_t * disab
     adb_DisableServiceResponse_set_DisableServiceResponse(ret, env, adbresp);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DisableService", (long)call_time, rc);
 
     return (ret);
@@ -532,7 +532,7 @@ adb_ShutdownServiceResponse_t *ShutdownServiceMarshal(adb_ShutdownService_t * sh
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256];
     ncMetadata ccMeta;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     adbinput = adb_ShutdownService_get_ShutdownService(shutdownService, env);
     adbresp = adb_shutdownServiceResponseType_create(env);
@@ -564,7 +564,7 @@ adb_ShutdownServiceResponse_t *ShutdownServiceMarshal(adb_ShutdownService_t * sh
     adb_ShutdownServiceResponse_set_ShutdownServiceResponse(ret, env, adbresp);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("ShutdownService", (long)call_time, rc);
     return (ret);
 }
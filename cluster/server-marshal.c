@@ -86,6 +86,7 @@
 #include "handlers.h"
 #include "server-marshal.h"
 #include <adb-helpers.h>
+#include <trace.h>
 
 
 
@@ -189,7 +190,7 @@ adb_AttachVolumeResponse_t *AttachVolumeMarshal(adb_AttachVolume_t * attachVolum
     char statusMessage[256];
     char *volumeId = NULL, *instanceId = NULL, *attachmentToken = NULL, *localDev = NULL;
     ncMetadata ccMeta;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     avt = adb_AttachVolume_get_AttachVolume(attachVolume, env);
 
@@ -203,7 +204,9 @@ adb_AttachVolumeResponse_t *AttachVolumeMarshal(adb_AttachVolume_t * attachVolum
     status = AXIS2_TRUE;
     if (!DONOTHING) {
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
+        int span = trace_begin_server("AttachVolume", ccMeta.correlationId);
         rc = doAttachVolume(&ccMeta, volumeId, instanceId, attachmentToken, localDev);
+        trace_end(span, (rc != 0));
         unset_corrid(corr_id);
         if (rc) {
             LOGERROR("doAttachVolume() failed: %d (%s, %s)\n", rc, volumeId, instanceId);
@@ -225,7 +228,7 @@ adb_AttachVolumeResponse_t *AttachVolumeMarshal(adb_AttachVolume_t * attachVolum
     adb_AttachVolumeResponse_set_AttachVolumeResponse(ret, env, avrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("AttachVolume", (long)call_time, rc);
 
     return (ret);
@@ -258,7 +261,7 @@ adb_DetachVolumeResponse_t *DetachVolumeMarshal(adb_DetachVolume_t * detachVolum
     char *localDev = NULL;
     int force = 0;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     dvt = adb_DetachVolume_get_DetachVolume(detachVolume, env);
 
@@ -278,7 +281,9 @@ adb_DetachVolumeResponse_t *DetachVolumeMarshal(adb_DetachVolume_t * detachVolum
     status = AXIS2_TRUE;
     if (!DONOTHING) {
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
+        int span = trace_begin_server("DetachVolume", ccMeta.correlationId);
         rc = doDetachVolume(&ccMeta, volumeId, instanceId, attachmentToken, localDev, force);
+        trace_end(span, (rc != 0));
         unset_corrid(corr_id);
         if (rc) {
             LOGERROR("doDetachVolume() failed: %d (%s, %s)\n", rc, volumeId, instanceId);
@@ -300,7 +305,7 @@ adb_DetachVolumeResponse_t *DetachVolumeMarshal(adb_DetachVolume_t * detachVolum
     adb_DetachVolumeResponse_set_DetachVolumeResponse(ret, env, dvrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DetachVolume", (long)call_time, rc);
 
     return (ret);
@@ -335,7 +340,7 @@ adb_BundleInstanceResponse_t *BundleInstanceMarshal(adb_BundleInstance_t * bundl
     char *S3PolicySig = NULL;
     char *architecture = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     bit = adb_BundleInstance_get_BundleInstance(bundleInstance, env);
 
@@ -375,7 +380,7 @@ adb_BundleInstanceResponse_t *BundleInstanceMarshal(adb_BundleInstance_t * bundl
     adb_BundleInstanceResponse_set_BundleInstanceResponse(ret, env, birt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("BundleInstance" , (long)call_time, rc);
 
     return (ret);
@@ -406,7 +411,7 @@ adb_BundleRestartInstanceResponse_t *BundleRestartInstanceMarshal(adb_BundleRest
     adb_BundleRestartInstanceResponse_t *ret = NULL;
     adb_bundleRestartInstanceResponseType_t *birt = NULL;
     adb_bundleRestartInstanceType_t *bit = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     bit = adb_BundleRestartInstance_get_BundleRestartInstance(bundleInstance, env);
 
@@ -436,7 +441,7 @@ adb_BundleRestartInstanceResponse_t *BundleRestartInstanceMarshal(adb_BundleRest
     adb_BundleRestartInstanceResponse_set_BundleRestartInstanceResponse(ret, env, birt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("BundleRestartInstance", (long)call_time, rc);
 
     return (ret);
@@ -464,7 +469,7 @@ adb_CancelBundleTaskResponse_t *CancelBundleTaskMarshal(adb_CancelBundleTask_t *
     char statusMessage[256] = { 0 };
     char *instanceId = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     bit = adb_CancelBundleTask_get_CancelBundleTask(cancelBundleTask, env);
 
@@ -497,7 +502,7 @@ adb_CancelBundleTaskResponse_t *CancelBundleTaskMarshal(adb_CancelBundleTask_t *
     adb_CancelBundleTaskResponse_set_CancelBundleTaskResponse(ret, env, birt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("CancelBundleTask", (long)call_time, rc);
 
     return (ret);
@@ -518,7 +523,7 @@ adb_CancelBundleTaskResponse_t *CancelBundleTaskMarshal(adb_CancelBundleTask_t *
 adb_DescribeSensorsResponse_t *DescribeSensorsMarshal(adb_DescribeSensors_t * describeSensors, const axutil_env_t * env)
 {
     int result = EUCA_ERROR;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
     adb_describeSensorsType_t *input = adb_DescribeSensors_get_DescribeSensors(describeSensors, env);
     adb_describeSensorsResponseType_t *output = adb_describeSensorsResponseType_create(env);
 
@@ -611,7 +616,7 @@ reply:
     LOGTRACE("done\n");
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DescribeSensors", (long)call_time, result);
 
 
@@ -642,7 +647,7 @@ adb_StopNetworkResponse_t *StopNetworkMarshal(adb_StopNetwork_t * stopNetwork, c
     char *netName = NULL;
     char *accountId = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     snt = adb_StopNetwork_get_StopNetwork(stopNetwork, env);
 
@@ -680,7 +685,7 @@ adb_StopNetworkResponse_t *StopNetworkMarshal(adb_StopNetwork_t * stopNetwork, c
     adb_StopNetworkResponse_set_StopNetworkResponse(ret, env, snrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("StopNetwork", (long)call_time, rc);
 
     return (ret);
@@ -718,7 +723,8 @@ adb_DescribeNetworksResponse_t *DescribeNetworksMarshal(adb_DescribeNetworks_t *
     int clusterControllersLen = 0;
     ncMetadata ccMeta = { 0 };
     vnetConfig *outvnetConfig = NULL;
-    long long call_time = time_ms();
+    netEntry *addrs = NULL;
+    long long call_time = mono_time_ms();
 
     outvnetConfig = EUCA_ZALLOC(1, sizeof(vnetConfig));
 
@@ -777,8 +783,9 @@ adb_DescribeNetworksResponse_t *DescribeNetworksMarshal(adb_DescribeNetworks_t *
                     adb_networkType_set_vlan(nt, env, i);
                     adb_networkType_set_netName(nt, env, outvnetConfig->users[i].netName);
                     adb_networkType_set_userName(nt, env, outvnetConfig->users[i].userName);
-                    for (j = 0; j < NUMBER_OF_HOSTS_PER_VLAN; j++) {
-                        if (outvnetConfig->networks[i].addrs[j].active) {
+                    addrs = vnetGetAddrs(outvnetConfig, i);
+                    for (j = 0; ((addrs != NULL) && (j < outvnetConfig->addrBlockSize)); j++) {
+                        if (addrs[j].active) {
                             adb_networkType_add_activeAddrs(nt, env, j);
                         }
                     }
@@ -808,7 +815,7 @@ adb_DescribeNetworksResponse_t *DescribeNetworksMarshal(adb_DescribeNetworks_t *
     EUCA_FREE(outvnetConfig);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DescribeNetworks", (long)call_time, rc);
 
     return (ret);
@@ -839,7 +846,7 @@ adb_DescribePublicAddressesResponse_t *DescribePublicAddressesMarshal(adb_Descri
     int i = 0;
     ncMetadata ccMeta = { 0 };
     publicip *outAddresses = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     dpa = adb_DescribePublicAddresses_get_DescribePublicAddresses(describePublicAddresses, env);
     EUCA_MESSAGE_UNMARSHAL(describePublicAddressesType, dpa, (&ccMeta));
@@ -885,6 +892,7 @@ adb_DescribePublicAddressesResponse_t *DescribePublicAddressesMarshal(adb_Descri
             adb_describePublicAddressesResponseType_add_addresses(dpart, env, addr);
         }
     }
+    EUCA_FREE(outAddresses);
 
     adb_describePublicAddressesResponseType_set_correlationId(dpart, env, ccMeta.correlationId);
     adb_describePublicAddressesResponseType_set_userId(dpart, env, ccMeta.userId);
@@ -897,7 +905,7 @@ adb_DescribePublicAddressesResponse_t *DescribePublicAddressesMarshal(adb_Descri
     adb_DescribePublicAddressesResponse_set_DescribePublicAddressesResponse(ret, env, dpart);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DescribePublicAddresses", (long)call_time, rc);
 
     return (ret);
@@ -925,7 +933,7 @@ adb_BroadcastNetworkInfoResponse_t *BroadcastNetworkInfoMarshal(adb_BroadcastNet
     char statusMessage[256] = { 0 };
     char *networkInfo = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     input = adb_BroadcastNetworkInfo_get_BroadcastNetworkInfo(broadcastNetworkInfo, env);
 
@@ -958,7 +966,7 @@ adb_BroadcastNetworkInfoResponse_t *BroadcastNetworkInfoMarshal(adb_BroadcastNet
     adb_BroadcastNetworkInfoResponse_set_BroadcastNetworkInfoResponse(ret, env, response);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("BroadcastNetworkInfo", (long)call_time, rc);
 
     return (ret);
@@ -988,7 +996,7 @@ adb_AssignAddressResponse_t *AssignAddressMarshal(adb_AssignAddress_t * assignAd
     char *dst = NULL;
     char *uuid = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     aat = adb_AssignAddress_get_AssignAddress(assignAddress, env);
 
@@ -1023,7 +1031,7 @@ adb_AssignAddressResponse_t *AssignAddressMarshal(adb_AssignAddress_t * assignAd
     adb_AssignAddressResponse_set_AssignAddressResponse(ret, env, aart);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("AssignAddress", (long)call_time, rc);
 
     return (ret);
@@ -1052,7 +1060,7 @@ adb_UnassignAddressResponse_t *UnassignAddressMarshal(adb_UnassignAddress_t * un
     char *src = NULL;
     char *dst = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     uat = adb_UnassignAddress_get_UnassignAddress(unassignAddress, env);
     EUCA_MESSAGE_UNMARSHAL(unassignAddressType, uat, (&ccMeta));
@@ -1085,7 +1093,7 @@ adb_UnassignAddressResponse_t *UnassignAddressMarshal(adb_UnassignAddress_t * un
     adb_UnassignAddressResponse_set_UnassignAddressResponse(ret, env, uart);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("UnassignAddress", (long)call_time, rc);
 
     return (ret);
@@ -1130,7 +1138,7 @@ adb_ConfigureNetworkResponse_t *ConfigureNetworkMarshal(adb_ConfigureNetwork_t *
     int namedLen = 0;
     int netLen = 0;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     cnt = adb_ConfigureNetwork_get_ConfigureNetwork(configureNetwork, env);
     EUCA_MESSAGE_UNMARSHAL(configureNetworkType, cnt, (&ccMeta));
@@ -1244,7 +1252,7 @@ adb_ConfigureNetworkResponse_t *ConfigureNetworkMarshal(adb_ConfigureNetwork_t *
     adb_ConfigureNetworkResponse_set_ConfigureNetworkResponse(ret, env, cnrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("ConfigureNetwork", (long)call_time, rc);
 
     return (ret);
@@ -1273,7 +1281,7 @@ adb_GetConsoleOutputResponse_t *GetConsoleOutputMarshal(adb_GetConsoleOutput_t *
     char *instId = NULL;
     char *output = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     gcot = adb_GetConsoleOutput_get_GetConsoleOutput(getConsoleOutput, env);
     EUCA_MESSAGE_UNMARSHAL(getConsoleOutputType, gcot, (&ccMeta));
@@ -1311,7 +1319,7 @@ adb_GetConsoleOutputResponse_t *GetConsoleOutputMarshal(adb_GetConsoleOutput_t *
     adb_GetConsoleOutputResponse_set_GetConsoleOutputResponse(ret, env, gcort);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("GetConsoleOutput", (long)call_time, rc);
 
     return (ret);
@@ -1347,7 +1355,7 @@ adb_StartNetworkResponse_t *StartNetworkMarshal(adb_StartNetwork_t * startNetwor
     int vlan = 0;
     int clusterControllersLen = 0;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     snt = adb_StartNetwork_get_StartNetwork(startNetwork, env);
     EUCA_MESSAGE_UNMARSHAL(startNetworkType, snt, (&ccMeta));
@@ -1398,7 +1406,7 @@ adb_StartNetworkResponse_t *StartNetworkMarshal(adb_StartNetwork_t * startNetwor
     adb_StartNetworkResponse_set_StartNetworkResponse(ret, env, snrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("StartNetwork", (long)call_time, rc);
 
     return (ret);
@@ -1434,7 +1442,7 @@ adb_DescribeResourcesResponse_t *DescribeResourcesMarshal(adb_DescribeResources_
     virtualMachine *vms = NULL;
     adb_virtualMachineType_t *vm = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     drt = adb_DescribeResources_get_DescribeResources(describeResources, env);
 
@@ -1504,7 +1512,7 @@ adb_DescribeResourcesResponse_t *DescribeResourcesMarshal(adb_DescribeResources_
     adb_DescribeResourcesResponse_set_DescribeResourcesResponse(ret, env, drrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DescribeResources", (long)call_time, rc);
     return (ret);
 }
@@ -1528,6 +1536,8 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     adb_describeInstancesType_t *dit = NULL;
     adb_ccInstanceType_t *it = NULL;
     char **instIds = NULL;
+    char *nextToken = NULL;
+    char token[32] = "";
     int instIdsLen = 0;
     int outInstsLen = 0;
     int i = 0;
@@ -1536,8 +1546,9 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     char statusMessage[256] = { 0 };
     ccInstance *outInsts = NULL;
     ccInstance *myInstance = NULL;
+    ccInstanceQuery query = { NULL };
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     dit = adb_DescribeInstances_get_DescribeInstances(describeInstances, env);
     EUCA_MESSAGE_UNMARSHAL(describeInstancesType, dit, (&ccMeta));
@@ -1548,16 +1559,36 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
         instIds[i] = adb_describeInstancesType_get_instanceIds_at(dit, env, i);
     }
 
+    // the filters, projection and paging are all optional, a CLC that sends none gets every instance
+    query.statesLen = adb_describeInstancesType_sizeof_states(dit, env);
+    query.states = EUCA_ZALLOC(query.statesLen, sizeof(char *));
+    for (i = 0; (query.states != NULL) && (i < query.statesLen); i++) {
+        query.states[i] = adb_describeInstancesType_get_states_at(dit, env, i);
+    }
+    query.ownerIdsLen = adb_describeInstancesType_sizeof_ownerIds(dit, env);
+    query.ownerIds = EUCA_ZALLOC(query.ownerIdsLen, sizeof(char *));
+    for (i = 0; (query.ownerIds != NULL) && (i < query.ownerIdsLen); i++) {
+        query.ownerIds[i] = adb_describeInstancesType_get_ownerIds_at(dit, env, i);
+    }
+    query.changedSince = (time_t) adb_describeInstancesType_get_changedSince(dit, env);
+    query.excludeUserData = ((adb_describeInstancesType_get_excludeUserData(dit, env) == AXIS2_TRUE) ? TRUE : FALSE);
+    query.maxResults = adb_describeInstancesType_get_maxResults(dit, env);
+    if ((nextToken = adb_describeInstancesType_get_nextToken(dit, env)) != NULL) {
+        query.cursor = atoi(nextToken);
+    }
+
     dirt = adb_describeInstancesResponseType_create(env);
 
     rc = 1;
     if (!DONOTHING) {
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
-        rc = doDescribeInstances(&ccMeta, instIds, instIdsLen, &outInsts, &outInstsLen);
+        rc = doDescribeInstances(&ccMeta, instIds, instIdsLen, &query, &outInsts, &outInstsLen);
         unset_corrid(corr_id);
     }
 
     EUCA_FREE(instIds);
+    EUCA_FREE(query.states);
+    EUCA_FREE(query.ownerIds);
     if (rc) {
         LOGERROR("doDescribeInstances() failed: %d (%d)\n", rc, instIdsLen);
         status = AXIS2_FALSE;
@@ -1571,7 +1602,21 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
             adb_describeInstancesResponseType_add_instances(dirt, env, it);
         }
         EUCA_FREE(outInsts);
+
+        for (i = 0; i < query.unchangedIdsLen; i++) {
+            adb_describeInstancesResponseType_add_unchangedInstanceIds(dirt, env, query.unchangedIds[i]);
+        }
+        adb_describeInstancesResponseType_set_timestamp(dirt, env, (int64_t) query.timestamp);
+        if (query.nextCursor >= 0) {
+            snprintf(token, sizeof(token), "%d", query.nextCursor);
+            adb_describeInstancesResponseType_set_nextToken(dirt, env, token);
+        }
+    }
+
+    for (i = 0; i < query.unchangedIdsLen; i++) {
+        EUCA_FREE(query.unchangedIds[i]);
     }
+    EUCA_FREE(query.unchangedIds);
 
     adb_describeInstancesResponseType_set_correlationId(dirt, env, ccMeta.correlationId);
     adb_describeInstancesResponseType_set_userId(dirt, env, ccMeta.userId);
@@ -1583,7 +1628,7 @@ adb_DescribeInstancesResponse_t *DescribeInstancesMarshal(adb_DescribeInstances_
     ret = adb_DescribeInstancesResponse_create(env);
     adb_DescribeInstancesResponse_set_DescribeInstancesResponse(ret, env, dirt);
 
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("DescribeInstances", (long)call_time, rc);
     return (ret);
 }
@@ -1752,7 +1797,7 @@ adb_RunInstancesResponse_t *RunInstancesMarshal(adb_RunInstances_t * runInstance
     ncMetadata ccMeta = { 0 };
     virtualMachine ccvm = { 0 };
     axutil_date_time_t *dt = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     rit = adb_RunInstances_get_RunInstances(runInstances, env);
     EUCA_MESSAGE_UNMARSHAL(runInstancesType, rit, (&ccMeta));
@@ -1863,9 +1908,11 @@ adb_RunInstancesResponse_t *RunInstancesMarshal(adb_RunInstances_t * runInstance
     rc = 1;
     if (!DONOTHING) {
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
+        int span = trace_begin_server("RunInstances", ccMeta.correlationId);
         rc = doRunInstances(&ccMeta, emiId, kernelId, ramdiskId, emiURL, kernelURL, ramdiskURL, instIds, instIdsLen, netNames, netNamesLen, macAddrs,
                             macAddrsLen, networkIndexList, networkIndexListLen, uuids, uuidsLen, privateIps, privateIpsLen, minCount, maxCount, accountId, ownerId,
                             reservationId, &ccvm, keyName, vlan, userData, credential, launchIndex, platform, expiryTime, NULL, rootDirective, &outInsts, &outInstsLen);
+        trace_end(span, (rc != 0));
         unset_corrid(corr_id);
     }
 
@@ -1905,7 +1952,7 @@ adb_RunInstancesResponse_t *RunInstancesMarshal(adb_RunInstances_t * runInstance
     EUCA_FREE(uuids);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("RunInstances", (long)call_time, rc);
 
     return (ret);
@@ -1935,7 +1982,7 @@ adb_RebootInstancesResponse_t *RebootInstancesMarshal(adb_RebootInstances_t * re
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256] = { 0 };
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     rit = adb_RebootInstances_get_RebootInstances(rebootInstances, env);
     EUCA_MESSAGE_UNMARSHAL(rebootInstancesType, rit, (&ccMeta));
@@ -1976,7 +2023,7 @@ adb_RebootInstancesResponse_t *RebootInstancesMarshal(adb_RebootInstances_t * re
     adb_RebootInstancesResponse_set_RebootInstancesResponse(ret, env, rirt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("RebootInstances", (long)call_time, rc);
 
     return (ret);
@@ -2009,7 +2056,7 @@ adb_TerminateInstancesResponse_t *TerminateInstancesMarshal(adb_TerminateInstanc
     axis2_bool_t forceBool = AXIS2_FALSE;
     char statusMessage[256] = { 0 };
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     tit = adb_TerminateInstances_get_TerminateInstances(terminateInstances, env);
     EUCA_MESSAGE_UNMARSHAL(terminateInstancesType, tit, (&ccMeta));
@@ -2031,7 +2078,9 @@ adb_TerminateInstancesResponse_t *TerminateInstancesMarshal(adb_TerminateInstanc
     if (!DONOTHING) {
         outStatus = EUCA_ZALLOC(instIdsLen, sizeof(int));
         threadCorrelationId *corr_id = set_corrid(ccMeta.correlationId);
+        int span = trace_begin_server("TerminateInstances", ccMeta.correlationId);
         rc = doTerminateInstances(&ccMeta, instIds, instIdsLen, force, &outStatus);
+        trace_end(span, (rc != 0));
         unset_corrid(corr_id);
     }
 
@@ -2064,7 +2113,7 @@ adb_TerminateInstancesResponse_t *TerminateInstancesMarshal(adb_TerminateInstanc
     adb_TerminateInstancesResponse_set_TerminateInstancesResponse(ret, env, tirt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("TerminateInstances", (long)call_time, rc);
 
     return (ret);
@@ -2094,7 +2143,7 @@ adb_CreateImageResponse_t *CreateImageMarshal(adb_CreateImage_t * createImage, c
     axis2_bool_t status = AXIS2_TRUE;
     char statusMessage[256] = { 0 };
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     cit = adb_CreateImage_get_CreateImage(createImage, env);
 
@@ -2131,7 +2180,7 @@ adb_CreateImageResponse_t *CreateImageMarshal(adb_CreateImage_t * createImage, c
     adb_CreateImageResponse_set_CreateImageResponse(ret, env, cirt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("CreateImage", (long)call_time, rc);
 
     return (ret);
@@ -2176,7 +2225,7 @@ adb_ModifyNodeResponse_t *ModifyNodeMarshal(adb_ModifyNode_t * modifyNode, const
     char *nodeName = NULL;
     char *stateName = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     mnt = adb_ModifyNode_get_ModifyNode(modifyNode, env);
 
@@ -2210,7 +2259,7 @@ adb_ModifyNodeResponse_t *ModifyNodeMarshal(adb_ModifyNode_t * modifyNode, const
     adb_ModifyNodeResponse_set_ModifyNodeResponse(ret, env, mnrt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("ModifyNode", (long)call_time, rc);
 
     return (ret);
@@ -2242,7 +2291,7 @@ adb_MigrateInstancesResponse_t *MigrateInstancesMarshal(adb_MigrateInstances_t *
     int destinationNodeCount = 0;
     int allowHosts;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     bzero(&ccMeta, sizeof(ncMetadata));
 
@@ -2291,7 +2340,7 @@ adb_MigrateInstancesResponse_t *MigrateInstancesMarshal(adb_MigrateInstances_t *
     EUCA_FREE(destinationNodes);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("MigrateInstances", (long)call_time, rc);
 
     return (ret);
@@ -2319,7 +2368,7 @@ adb_StartInstanceResponse_t *StartInstanceMarshal(adb_StartInstance_t * startIns
     char statusMessage[256] = { 0 };
     char *instanceId = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     bzero(&ccMeta, sizeof(ncMetadata));
 
@@ -2359,7 +2408,7 @@ adb_StartInstanceResponse_t *StartInstanceMarshal(adb_StartInstance_t * startIns
     adb_StartInstanceResponse_set_StartInstanceResponse(ret, env, mirt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("StartInstance", (long)call_time, rc);
 
     return (ret);
@@ -2387,7 +2436,7 @@ adb_StopInstanceResponse_t *StopInstanceMarshal(adb_StopInstance_t * stopInstanc
     char statusMessage[256] = { 0 };
     char *instanceId = NULL;
     ncMetadata ccMeta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     bzero(&ccMeta, sizeof(ncMetadata));
 
@@ -2426,7 +2475,7 @@ adb_StopInstanceResponse_t *StopInstanceMarshal(adb_StopInstance_t * stopInstanc
     adb_StopInstanceResponse_set_StopInstanceResponse(ret, env, mirt);
 
     //update stats and return
-    call_time = time_ms() - call_time;
+    call_time = mono_time_ms() - call_time;
     cached_message_stats_update("StopInstance", (long)call_time, rc);
 
     return (ret);
@@ -76,9 +76,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gl-client-marshal.h>
 #include <euca_auth.h>
 #include <eucalyptus.h>
+#include <misc.h>
+
+#if defined(HAVE_ZLIB_H)
+#include <zlib.h>
+#endif /* HAVE_ZLIB_H */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -86,6 +92,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define FOLLOW_WAIT_SEC                             10  //!< how long each request of followLog waits for new lines
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -130,6 +138,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int print_chunk(const logChunk * chunk);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -158,7 +168,9 @@
 //!
 //! @pre \li The argc parameter must be at least 4
 //!      \li The AXIS2C_HOME environment variable must be set
-//!      \li The request argument must be getLogs or getKeys only
+//!      \li The request argument must be getKeys, getLogChunk or followLog only,
+//!          the last two taking the log name, then optionally the offset, the
+//!          lowest level, and the time range in seconds since the epoch
 //!
 //! @post On success, the output for getKeys or getLogs will be displayed
 //!       to stdout. On failure, the proper error message will be displayed.
@@ -170,8 +182,19 @@ int main(int argc, char **argv)
 #define REQUEST_ARG    2
 #define SERVICE_ARG    3
 #define NB_ARG         4
+#define LOGNAME_ARG    4
+#define OFFSET_ARG     5
+#define LEVEL_ARG      6
+#define SINCE_ARG      7
+#define UNTIL_ARG      8
 
     int rc = EUCA_OK;
+    int follow = 0;
+    long long offset = 0;
+    long long since = 0;
+    long long until = 0;
+    char *level = NULL;
+    logChunk chunk = { {0} };
     char *cccert = NULL;
     char *nccert = NULL;
     axutil_env_t *env = NULL;
@@ -219,6 +242,32 @@ int main(int argc, char **argv)
             if (nccert)
                 printf("NCCERT\n----------\n%s\n-----------\n", base64_dec(((unsigned char *)nccert), strlen(nccert)));
         }
+    } else if (!strcmp(argv[REQUEST_ARG], "getLogChunk") || !strcmp(argv[REQUEST_ARG], "followLog")) {
+        if (argc <= LOGNAME_ARG) {
+            printf("ERROR: %s needs a log name\n", argv[REQUEST_ARG]);
+            return (EUCA_INVALID_ERROR);
+        }
+
+        offset = ((argc > OFFSET_ARG) ? atoll(argv[OFFSET_ARG]) : 0);
+        level = ((argc > LEVEL_ARG) ? argv[LEVEL_ARG] : NULL);
+        since = ((argc > SINCE_ARG) ? atoll(argv[SINCE_ARG]) : 0);
+        until = ((argc > UNTIL_ARG) ? atoll(argv[UNTIL_ARG]) : 0);
+        follow = (!strcmp(argv[REQUEST_ARG], "followLog") ? FOLLOW_WAIT_SEC : 0);
+
+        // ask for chunk after chunk, until the end of the log unless following it
+        do {
+            if ((rc = gl_getLogChunk(argv[SERVICE_ARG], argv[LOGNAME_ARG], offset, 0, since, until, level, follow, &chunk, env, stub)) != EUCA_OK)
+                break;
+
+            if ((rc = print_chunk(&chunk)) != EUCA_OK)
+                break;
+
+            if (follow == 0)
+                fprintf(stderr, "nextOffset=%lld fileSize=%lld\n", chunk.nextOffset, chunk.fileSize);
+            offset = chunk.nextOffset;
+            EUCA_FREE(chunk.data);
+        } while ((follow > 0) || (chunk.nextOffset < chunk.fileSize));
+        EUCA_FREE(chunk.data);
     } else {
         printf("ERROR: Invalid argument %s\n", argv[REQUEST_ARG]);
         return (EUCA_INVALID_ERROR);
@@ -231,4 +280,57 @@ int main(int argc, char **argv)
 #undef REQUEST_ARG
 #undef SERVICE_ARG
 #undef NB_ARG
+#undef LOGNAME_ARG
+#undef OFFSET_ARG
+#undef LEVEL_ARG
+#undef SINCE_ARG
+#undef UNTIL_ARG
+}
+
+//!
+//! Decodes a log chunk and prints its lines to stdout
+//!
+//! @param[in] chunk the chunk from gl_getLogChunk()
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the chunk cannot be decoded
+//!
+static int print_chunk(const logChunk * chunk)
+{
+    int len = 0;
+    char *raw = NULL;
+    char *text = NULL;
+
+    if ((chunk->data == NULL) || (chunk->dataLength <= 0))
+        return (EUCA_OK);
+
+    if ((raw = base64_dec2(((unsigned char *)chunk->data), strlen(chunk->data), &len)) == NULL) {
+        printf("ERROR: cannot decode log chunk\n");
+        return (EUCA_ERROR);
+    }
+
+    if (!strcmp(chunk->encoding, "none")) {
+        text = raw;
+        raw = NULL;
+        len = MIN(len, chunk->dataLength);
+    } else {
+#if defined(HAVE_ZLIB_H)
+        uLongf textLen = chunk->dataLength;
+        if (strcmp(chunk->encoding, "zlib") || ((text = EUCA_ALLOC(textLen, sizeof(char))) == NULL) ||
+            (uncompress(((Bytef *) text), &textLen, ((const Bytef *)raw), len) != Z_OK)) {
+            EUCA_FREE(text);
+        }
+        len = textLen;
+#endif /* HAVE_ZLIB_H */
+    }
+    EUCA_FREE(raw);
+
+    if (text == NULL) {
+        printf("ERROR: cannot decode log chunk encoded with %s\n", chunk->encoding);
+        return (EUCA_ERROR);
+    }
+
+    fwrite(text, sizeof(char), len, stdout);
+    fflush(stdout);
+    EUCA_FREE(text);
+    return (EUCA_OK);
 }
@@ -93,6 +93,7 @@
 #include <gl-client-marshal.h>
 #include <eucalyptus.h>
 #include <euca_auth.h>
+#include <euca_string.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -234,3 +235,71 @@ int gl_getKeys(char *service, char **outCCCert, char **outNCCert, axutil_env_t *
     *outNCCert = adb_getKeysResponseType_get_NCcert(response, env);
     return (EUCA_OK);
 }
+
+//!
+//! Client side of the get log chunk service request
+//!
+//! @param[in]  service service name identifier
+//! @param[in]  logName the log to read
+//! @param[in]  offset where in the log to start
+//! @param[in]  maxBytes most log bytes to read, or 0 for the default
+//! @param[in]  since if not 0, lines logged before this time are left out
+//! @param[in]  until if not 0, lines logged after this time are left out
+//! @param[in]  level if not NULL, lines logged at a lower level are left out
+//! @param[in]  follow how many seconds to wait for new lines at the end of the log
+//! @param[out] outChunk the chunk
+//! @param[in]  env pointer to the AXIS2 environment
+//! @param[in]  stub pointer to the AXIS2 stub
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+//! @see doGetLogChunk()
+//!
+int gl_getLogChunk(char *service, char *logName, long long offset, int maxBytes, long long since, long long until, char *level, int follow, logChunk * outChunk,
+                   axutil_env_t * env, axis2_stub_t * stub)
+{
+    char *data = NULL;
+    char *encoding = NULL;
+    adb_GetLogChunkResponse_t *out = NULL;
+    adb_getLogChunkResponseType_t *response = NULL;
+    adb_GetLogChunk_t *in = NULL;
+    adb_getLogChunkType_t *request = NULL;
+
+    bzero(outChunk, sizeof(logChunk));
+
+    request = adb_getLogChunkType_create(env);
+    adb_getLogChunkType_set_userId(request, env, "eucalyptus");
+    adb_getLogChunkType_set_correlationId(request, env, "12345678");
+    adb_getLogChunkType_set_serviceTag(request, env, service);
+    adb_getLogChunkType_set_logName(request, env, logName);
+    adb_getLogChunkType_set_offset(request, env, offset);
+    adb_getLogChunkType_set_maxBytes(request, env, maxBytes);
+    adb_getLogChunkType_set_since(request, env, since);
+    adb_getLogChunkType_set_until(request, env, until);
+    if (level)
+        adb_getLogChunkType_set_level(request, env, level);
+    adb_getLogChunkType_set_follow(request, env, follow);
+
+    in = adb_GetLogChunk_create(env);
+    adb_GetLogChunk_set_GetLogChunk(in, env, request);
+
+    if ((out = axis2_stub_op_EucalyptusGL_GetLogChunk(stub, env, in)) == NULL) {
+        printf("ERROR: operation call failed\n");
+        return (EUCA_ERROR);
+    }
+
+    response = adb_GetLogChunkResponse_get_GetLogChunkResponse(out, env);
+    if (adb_getLogChunkResponseType_get_return(response, env) == AXIS2_FALSE) {
+        printf("ERROR: operation returned an error\n");
+        return (EUCA_ERROR);
+    }
+
+    if ((encoding = adb_getLogChunkResponseType_get_encoding(response, env)) != NULL)
+        euca_strncpy(outChunk->encoding, encoding, sizeof(outChunk->encoding));
+    if ((data = adb_getLogChunkResponseType_get_data(response, env)) != NULL)
+        outChunk->data = strdup(data);
+    outChunk->dataLength = adb_getLogChunkResponseType_get_dataLength(response, env);
+    outChunk->nextOffset = adb_getLogChunkResponseType_get_nextOffset(response, env);
+    outChunk->fileSize = adb_getLogChunkResponseType_get_fileSize(response, env);
+    return (EUCA_OK);
+}
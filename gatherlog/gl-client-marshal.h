@@ -81,6 +81,7 @@
 #include <time.h>
 #include <eucalyptus.h>
 #include "axis2_stub_EucalyptusGL.h"
+#include <handlers.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -120,6 +121,8 @@
 
 //int gl_getLogs(char *service, char **outCClog, char **outNClog, char **outHlog, char **outAlog, axutil_env_t * env, axis2_stub_t * stub);
 int gl_getKeys(char *service, char **outCCCert, char **outNCCert, axutil_env_t * env, axis2_stub_t * stub);
+int gl_getLogChunk(char *service, char *logName, long long offset, int maxBytes, long long since, long long until, char *level, int follow, logChunk * outChunk,
+                   axutil_env_t * env, axis2_stub_t * stub);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
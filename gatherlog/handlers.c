@@ -74,9 +74,16 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE                    // memrchr, strptime
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <linux/limits.h>
@@ -86,6 +93,13 @@
 #include <euca_auth.h>
 
 #include <eucalyptus.h>
+#include <misc.h>
+#include <log.h>
+#include <euca_string.h>
+
+#if defined(HAVE_ZLIB_H)
+#include <zlib.h>
+#endif /* HAVE_ZLIB_H */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -93,6 +107,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define GL_SEEK_WINDOW                           (16 * 1024)    //!< bytes of a log read at each step of the bisection for a time range
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -111,6 +127,23 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! The filters applied to the lines of a log chunk
+typedef struct glFilter_t {
+    time_t since;                      //!< if not 0, lines logged before are left out
+    time_t until;                      //!< if not 0, lines logged after are left out
+    int level;                         //!< lines logged at a lower level are left out
+    boolean keep;                      //!< whether the previous line was kept, for the lines that continue it
+    char stamp[20];                    //!< the last timestamp converted
+    time_t stamp_time;                 //!< and what it was converted to
+} glFilter;
+
+//! What the process asking another service for a log chunk passes back ahead of the data
+typedef struct glChunkHeader_t {
+    int rc;                            //!< the result of the request
+    logChunk chunk;                    //!< the chunk, without its data
+    size_t dataSize;                   //!< the length of the data that follows
+} glChunkHeader;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -137,6 +170,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int gl_log_path(const char *logName, char *path, int pathLen);
+static int gl_read_chunk(const char *path, long long offset, int maxBytes, long long since, long long until, int minLevel, int follow, logChunk * outChunk);
+static boolean gl_filter_line(glFilter * filter, const char *line, size_t len);
+static int gl_parse_line(glFilter * filter, const char *line, size_t len, time_t * pStamp, int *pLevel);
+static off_t gl_seek_time(int fd, off_t size, glFilter * filter);
+static int gl_encode(const char *buf, size_t len, logChunk * outChunk);
+static int gl_read_full(int fd, void *buf, size_t len);
+static int gl_write_full(int fd, const void *buf, size_t len);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -467,3 +509,508 @@ int doGetKeys(char *service, char **outCCCert, char **outNCCert)
     EUCA_FREE(buf);
     return (EUCA_OK);
 }
+
+//!
+//! Handles the get log chunk service request. Rather than the whole of a log, it returns the
+//! lines of a chunk of it that pass the time range and level filters, compressed, along with
+//! the offset to ask for the next chunk from. Asking again from that offset follows the log as
+//! it grows, and a request at the end of the log may wait for new lines to come.
+//!
+//! @param[in]  service service name identifier, "self" for the logs of this host
+//! @param[in]  logName the log to read: "cc", "nc", "httpd" or "axis2", with a ".N" suffix for a rotated one
+//! @param[in]  offset where in the log to start, from nextOffset of the previous chunk
+//! @param[in]  maxBytes most log bytes to read, or 0 for GL_CHUNK_DEFAULT_BYTES
+//! @param[in]  since if not 0, lines logged before this time are left out
+//! @param[in]  until if not 0, lines logged after this time are left out
+//! @param[in]  level if not NULL or empty, lines logged at a lower level are left out
+//! @param[in]  follow how many seconds to wait for new lines when offset is at the end of the log
+//! @param[out] outChunk the chunk, whose data the caller must free
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_MEMORY_ERROR: if we fail to allocate memory
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_ACCESS_ERROR: if the log cannot be read
+//!         \li EUCA_ERROR: if the service could not be asked for the chunk
+//!
+//! @pre The service, logName and outChunk parameters must be non-NULLs.
+//!
+//! @note when the log was truncated or rotated since offset was given, the chunk starts over
+//!       from the beginning of the log, which the caller sees as a nextOffset below offset
+//!
+int doGetLogChunk(char *service, char *logName, long long offset, int maxBytes, long long since, long long until, char *level, int follow, logChunk * outChunk)
+{
+    int rc = EUCA_OK;
+    int pid = 0;
+    int status = 0;
+    int filedes[2] = { 0 };
+    int minLevel = EUCA_LOG_ALL;
+    char path[EUCA_MAX_PATH] = "";
+    logChunk chunk = { {0} };
+    glChunkHeader header = { 0 };
+    axutil_env_t *env = NULL;
+    axis2_char_t *client_home = NULL;
+    axis2_stub_t *stub = NULL;
+
+    if (!service || !logName || !outChunk || (offset < 0) || (maxBytes < 0) || (follow < 0)) {
+        printf("ERROR: Invalid params: service=%s, logName=%s, offset=%lld, maxBytes=%d, follow=%d, outChunk=%p\n", SP(service), SP(logName), offset, maxBytes, follow, outChunk);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    bzero(outChunk, sizeof(logChunk));
+    if (maxBytes == 0)
+        maxBytes = GL_CHUNK_DEFAULT_BYTES;
+    maxBytes = MIN(maxBytes, GL_CHUNK_MAX_BYTES);
+    follow = MIN(follow, GL_FOLLOW_MAX_SEC);
+
+    if (level && (level[0] != '\0') && ((minLevel = log_level_int(level)) < 0)) {
+        printf("ERROR: Invalid log level %s\n", level);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (!strcmp(service, "self")) {
+        if ((rc = gl_log_path(logName, path, sizeof(path))) != EUCA_OK) {
+            printf("ERROR: Invalid log name %s\n", logName);
+            return (rc);
+        }
+        return (gl_read_chunk(path, offset, maxBytes, since, until, minLevel, follow, outChunk));
+    }
+    // the chunk is filtered and compressed by the service, it is only passed along from here
+    if (pipe(filedes) != 0)
+        return (EUCA_ERROR);
+
+    if ((pid = fork()) == 0) {
+        close(filedes[0]);
+
+        env = axutil_env_create_all(NULL, 0);
+        if ((client_home = AXIS2_GETENV("AXIS2C_HOME")) == NULL) {
+            printf("ERROR: cannot retrieve AXIS2_HOME environment variable.\n");
+            exit(1);
+        } else if ((stub = axis2_stub_create_EucalyptusGL(env, client_home, service)) == NULL) {
+            printf("ERROR: cannot retrieve AXIS2 stub.\n");
+            exit(1);
+        }
+
+        header.rc = gl_getLogChunk("self", logName, offset, maxBytes, since, until, level, follow, &chunk, env, stub);
+        header.chunk = chunk;
+        header.chunk.data = NULL;
+        header.dataSize = ((chunk.data != NULL) ? strlen(chunk.data) : 0);
+        if (gl_write_full(filedes[1], &header, sizeof(header)) == EUCA_OK)
+            gl_write_full(filedes[1], chunk.data, header.dataSize);
+        close(filedes[1]);
+        exit(0);
+    }
+
+    close(filedes[1]);
+    if (pid < 0) {
+        close(filedes[0]);
+        return (EUCA_ERROR);
+    }
+
+    if ((rc = gl_read_full(filedes[0], &header, sizeof(header))) == EUCA_OK) {
+        if ((rc = header.rc) == EUCA_OK) {
+            *outChunk = header.chunk;
+            if (header.dataSize > 0) {
+                if ((outChunk->data = EUCA_ALLOC((header.dataSize + 1), sizeof(char))) == NULL) {
+                    rc = EUCA_MEMORY_ERROR;
+                } else if ((rc = gl_read_full(filedes[0], outChunk->data, header.dataSize)) != EUCA_OK) {
+                    EUCA_FREE(outChunk->data);
+                } else {
+                    outChunk->data[header.dataSize] = '\0';
+                }
+            }
+        }
+    }
+
+    if (rc != EUCA_OK)
+        bzero(outChunk, sizeof(logChunk));
+    close(filedes[0]);
+    waitpid(pid, &status, 0);
+    return (rc);
+}
+
+//!
+//! Finds the file of a log of this host
+//!
+//! @param[in]  logName "cc", "nc", "httpd" or "axis2", with a ".N" suffix for a rotated one
+//! @param[out] path set to the path of the log
+//! @param[in]  pathLen size of path
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if logName is not one of the logs
+//!
+static int gl_log_path(const char *logName, char *path, int pathLen)
+{
+    int i = 0;
+    int nameLen = 0;
+    char *home = NULL;
+    const char *rotation = NULL;
+    const char *file = NULL;
+    char httpd[EUCA_MAX_PATH] = "";
+    static const char *logs[][2] = {
+        {"cc", "cc.log"},
+        {"nc", "nc.log"},
+        {"axis2", "axis2c.log"},
+        {"httpd", "httpd-nc_error_log"},
+    };
+
+    // a rotated log is named after the log, with a number
+    if ((rotation = strchr(logName, '.')) != NULL) {
+        if ((rotation[1] == '\0') || (strspn((rotation + 1), "0123456789") != strlen(rotation + 1)))
+            return (EUCA_INVALID_ERROR);
+        nameLen = (rotation - logName);
+    } else {
+        rotation = "";
+        nameLen = strlen(logName);
+    }
+
+    for (i = 0; (i < (sizeof(logs) / sizeof(logs[0]))) && (file == NULL); i++) {
+        if ((strlen(logs[i][0]) == nameLen) && !strncmp(logs[i][0], logName, nameLen))
+            file = logs[i][1];
+    }
+
+    if (file == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    if ((home = getenv("EUCALYPTUS")) == NULL)
+        home = "";
+
+    // the httpd log of a CC has its own name
+    if (!strcmp(file, "httpd-nc_error_log")) {
+        snprintf(httpd, sizeof(httpd), EUCALYPTUS_LOG_DIR "/%s%s", home, file, rotation);
+        if (access(httpd, R_OK) != 0)
+            file = "httpd-cc_error_log";
+    }
+
+    snprintf(path, pathLen, EUCALYPTUS_LOG_DIR "/%s%s", home, file, rotation);
+    return (EUCA_OK);
+}
+
+//!
+//! Reads a chunk of a log file, keeps the lines of it that pass the filters and encodes them
+//!
+//! @param[in]  path the log file
+//! @param[in]  offset where to start
+//! @param[in]  maxBytes most bytes to read
+//! @param[in]  since if not 0, lines logged before this time are left out
+//! @param[in]  until if not 0, lines logged after this time are left out
+//! @param[in]  minLevel lines logged at a lower level are left out
+//! @param[in]  follow how many seconds to wait for new lines when offset is at the end of the log
+//! @param[out] outChunk the chunk
+//!
+//! @return EUCA_OK on success or EUCA_ACCESS_ERROR or EUCA_MEMORY_ERROR on failure
+//!
+static int gl_read_chunk(const char *path, long long offset, int maxBytes, long long since, long long until, int minLevel, int follow, logChunk * outChunk)
+{
+    int fd = -1;
+    int rc = EUCA_OK;
+    int waited = 0;
+    char *buf = NULL;
+    char *line = NULL;
+    char *end = NULL;
+    char *eol = NULL;
+    size_t len = 0;
+    size_t kept = 0;
+    ssize_t bytes = 0;
+    glFilter filter = { 0 };
+    struct stat fdstat = { 0 };
+    struct stat pathstat = { 0 };
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        printf("ERROR: cannot open log %s\n", path);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    if (fstat(fd, &fdstat) != 0) {
+        close(fd);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    // a log smaller than the offset was truncated or rotated, start over
+    if (offset > fdstat.st_size)
+        offset = 0;
+
+    // wait for the log to grow, unless it gets rotated in the meantime
+    while ((offset == fdstat.st_size) && (waited++ < follow)) {
+        sleep(1);
+        if ((fstat(fd, &fdstat) != 0) || (stat(path, &pathstat) != 0) || (pathstat.st_ino != fdstat.st_ino))
+            break;
+    }
+
+    filter.since = since;
+    filter.until = until;
+    filter.level = minLevel;
+    filter.keep = ((since == 0) && (until == 0) && (minLevel == EUCA_LOG_ALL));
+
+    // no need to go through the lines logged before the range
+    if ((since > 0) && (fdstat.st_size > offset))
+        offset = MAX(offset, gl_seek_time(fd, fdstat.st_size, &filter));
+
+    outChunk->fileSize = fdstat.st_size;
+    outChunk->nextOffset = offset;
+    euca_strncpy(outChunk->encoding, "none", sizeof(outChunk->encoding));
+    if ((len = MIN((long long)maxBytes, (fdstat.st_size - offset))) == 0) {
+        close(fd);
+        return (EUCA_OK);
+    }
+
+    if ((buf = EUCA_ALLOC((len + 1), sizeof(char))) == NULL) {
+        close(fd);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    while ((bytes = pread(fd, buf, len, offset)) < 0) {
+        if (errno != EINTR) {
+            printf("ERROR: cannot read log %s\n", path);
+            EUCA_FREE(buf);
+            close(fd);
+            return (EUCA_ACCESS_ERROR);
+        }
+    }
+    close(fd);
+
+    // a chunk ends with the last whole line in it, unless it is all one line
+    len = bytes;
+    buf[len] = '\0';
+    if ((offset + len) < fdstat.st_size) {
+        if ((eol = memrchr(buf, '\n', len)) != NULL)
+            len = (eol - buf) + 1;
+    }
+    outChunk->nextOffset = offset + len;
+
+    for (line = buf, end = (buf + len); line < end; line = eol) {
+        if ((eol = memchr(line, '\n', (end - line))) != NULL)
+            eol++;
+        else
+            eol = end;
+
+        if (gl_filter_line(&filter, line, (eol - line))) {
+            memmove((buf + kept), line, (eol - line));
+            kept += (eol - line);
+        }
+    }
+
+    if (kept > 0) {
+        outChunk->dataLength = kept;
+        rc = gl_encode(buf, kept, outChunk);
+    }
+
+    EUCA_FREE(buf);
+    return (rc);
+}
+
+//!
+//! Tells whether a line of a log passes the filters. A line that does not start with a timestamp
+//! and a level continues the previous one, and is kept if the previous one was.
+//!
+//! @param[in,out] filter the filters, which remember the previous line
+//! @param[in]     line the line
+//! @param[in]     len its length
+//!
+//! @return TRUE if the line is kept or FALSE otherwise
+//!
+static boolean gl_filter_line(glFilter * filter, const char *line, size_t len)
+{
+    int level = EUCA_LOG_ALL;
+    time_t stamp = 0;
+
+    if (gl_parse_line(filter, line, len, &stamp, &level) == EUCA_OK) {
+        filter->keep = ((level >= filter->level) && ((filter->since == 0) || (stamp >= filter->since)) && ((filter->until == 0) || (stamp <= filter->until)));
+    }
+    return (filter->keep);
+}
+
+//!
+//! Parses the timestamp and the level that start a line of a log, as log.c prints them:
+//! "YYYY-MM-DD HH:MM:SS LEVEL", with an optional ".UUUUUU" after the seconds.
+//!
+//! @param[in,out] filter remembers the last timestamp converted, so it is only redone when it changes
+//! @param[in]     line the line
+//! @param[in]     len its length
+//! @param[out]    pStamp set to the time of the line
+//! @param[out]    pLevel set to the level of the line
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the line does not start with them
+//!
+static int gl_parse_line(glFilter * filter, const char *line, size_t len, time_t * pStamp, int *pLevel)
+{
+#define STAMP_LEN             19
+#define LEVEL_LEN              5
+#define USEC_LEN               7
+
+    int l = 0;
+    size_t pos = STAMP_LEN;
+    size_t skip = 0;
+    struct tm tm = { 0 };
+
+    if ((len < (STAMP_LEN + 1 + LEVEL_LEN)) || !isdigit(line[0]) || (line[4] != '-') || (line[13] != ':') || (line[16] != ':'))
+        return (EUCA_INVALID_ERROR);
+
+    if (memcmp(filter->stamp, line, STAMP_LEN)) {
+        bzero(&tm, sizeof(tm));
+        if (strptime(line, "%Y-%m-%d %H:%M:%S", &tm) != (line + STAMP_LEN))
+            return (EUCA_INVALID_ERROR);
+        tm.tm_isdst = -1;
+        memcpy(filter->stamp, line, STAMP_LEN);
+        filter->stamp_time = mktime(&tm);
+    }
+
+    if ((line[pos] == '.') && (len >= (STAMP_LEN + USEC_LEN + 1 + LEVEL_LEN)))
+        pos += USEC_LEN;
+
+    // the level is right aligned on LEVEL_LEN characters, and longer ones are cut
+    if (line[pos++] != ' ')
+        return (EUCA_INVALID_ERROR);
+    for (skip = 0; (skip < LEVEL_LEN) && (line[pos + skip] == ' '); skip++) ;
+    if (skip == LEVEL_LEN)
+        return (EUCA_INVALID_ERROR);
+
+    for (l = EUCA_LOG_EXTREME; l <= EUCA_LOG_FATAL; l++) {
+        if (!strncmp(log_level_names[l], (line + pos + skip), (LEVEL_LEN - skip))) {
+            *pStamp = filter->stamp_time;
+            *pLevel = l;
+            return (EUCA_OK);
+        }
+    }
+    return (EUCA_INVALID_ERROR);
+
+#undef STAMP_LEN
+#undef LEVEL_LEN
+#undef USEC_LEN
+}
+
+//!
+//! Finds a point of a log before which all lines were logged before filter->since, by
+//! bisection over the timestamps of the lines, so a time range is found in a large log
+//! without reading it all
+//!
+//! @param[in]     fd the log file
+//! @param[in]     size its size
+//! @param[in,out] filter the filters
+//!
+//! @return the offset of the start of a line, 0 if no line of the log is known to be before the range
+//!
+static off_t gl_seek_time(int fd, off_t size, glFilter * filter)
+{
+    int level = 0;
+    char *eol = NULL;
+    char *line = NULL;
+    char window[GL_SEEK_WINDOW + 1] = "";
+    off_t lo = 0;
+    off_t hi = size;
+    off_t mid = 0;
+    off_t found = 0;
+    time_t stamp = 0;
+    ssize_t bytes = 0;
+
+    while ((hi - lo) > GL_SEEK_WINDOW) {
+        mid = lo + ((hi - lo) / 2);
+        if ((bytes = pread(fd, window, GL_SEEK_WINDOW, mid)) <= 0)
+            break;
+        window[bytes] = '\0';
+
+        // the first whole line of the window that has a timestamp
+        found = -1;
+        for (line = memchr(window, '\n', bytes); line && (++line < (window + bytes)); line = eol) {
+            if ((eol = memchr(line, '\n', ((window + bytes) - line))) == NULL)
+                break;
+            if (gl_parse_line(filter, line, (eol - line), &stamp, &level) == EUCA_OK) {
+                found = mid + (line - window);
+                break;
+            }
+        }
+
+        if (found < 0)
+            break;
+
+        if (stamp < filter->since)
+            lo = found;
+        else
+            hi = mid;
+    }
+    return (lo);
+}
+
+//!
+//! Encodes the content of a chunk, deflated if zlib is available
+//!
+//! @param[in]  buf the content
+//! @param[in]  len its length
+//! @param[out] outChunk the chunk to set the encoding and the data of
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR on failure
+//!
+static int gl_encode(const char *buf, size_t len, logChunk * outChunk)
+{
+#if defined(HAVE_ZLIB_H)
+    int rc = 0;
+    char *zbuf = NULL;
+    uLongf zlen = compressBound(len);
+
+    if ((zbuf = EUCA_ALLOC(zlen, sizeof(char))) != NULL) {
+        if ((rc = compress2(((Bytef *) zbuf), &zlen, ((const Bytef *)buf), len, Z_BEST_SPEED)) == Z_OK) {
+            euca_strncpy(outChunk->encoding, "zlib", sizeof(outChunk->encoding));
+            outChunk->data = base64_enc(((u8 *) zbuf), zlen);
+        } else {
+            printf("WARN: cannot deflate log chunk (%d), sending it as is\n", rc);
+        }
+        EUCA_FREE(zbuf);
+    }
+#endif /* HAVE_ZLIB_H */
+
+    if (outChunk->data == NULL) {
+        euca_strncpy(outChunk->encoding, "none", sizeof(outChunk->encoding));
+        outChunk->data = base64_enc(((u8 *) buf), len);
+    }
+    return ((outChunk->data != NULL) ? EUCA_OK : EUCA_MEMORY_ERROR);
+}
+
+//!
+//! Reads exactly len bytes from a file descriptor
+//!
+//! @param[in]  fd
+//! @param[out] buf
+//! @param[in]  len
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR on failure or early end of file
+//!
+static int gl_read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t bytes = 0;
+
+    while (done < len) {
+        if ((bytes = read(fd, (((char *)buf) + done), (len - done))) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        if (bytes == 0)
+            return (EUCA_IO_ERROR);
+        done += bytes;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Writes exactly len bytes to a file descriptor
+//!
+//! @param[in] fd
+//! @param[in] buf
+//! @param[in] len
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR on failure
+//!
+static int gl_write_full(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t bytes = 0;
+
+    while (done < len) {
+        if ((bytes = write(fd, (((const char *)buf) + done), (len - done))) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        done += bytes;
+    }
+    return (EUCA_OK);
+}
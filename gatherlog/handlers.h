@@ -83,6 +83,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define GL_CHUNK_DEFAULT_BYTES                   (1024 * 1024)  //!< log bytes read for a chunk when the request does not say
+#define GL_CHUNK_MAX_BYTES                   (8 * 1024 * 1024)  //!< most log bytes read for a chunk
+#define GL_FOLLOW_MAX_SEC                                   60  //!< longest a request waits for a log to grow
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -101,6 +105,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A chunk of a log file, as returned by doGetLogChunk()
+typedef struct logChunk_t {
+    char encoding[16];                 //!< how data is encoded: "zlib" for base64 of the deflated content, "none" for base64 of the content
+    char *data;                        //!< the encoded content, or NULL if no line of the chunk passed the filters
+    int dataLength;                    //!< the length of the content before it was encoded
+    long long nextOffset;              //!< where in the log the next chunk starts, to resume from
+    long long fileSize;                //!< the size of the log when the chunk was read
+} logChunk;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -115,6 +128,7 @@
 
 //int doGetLogs(char *service, char **outCCLog, char **outNCLog, char **outHTTPDLog, char **outAxis2Log);
 int doGetKeys(char *service, char **outCCCert, char **outNCCert);
+int doGetLogChunk(char *service, char *logName, long long offset, int maxBytes, long long since, long long until, char *level, int follow, logChunk * outChunk);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
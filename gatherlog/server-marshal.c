@@ -268,3 +268,62 @@ adb_GetKeysResponse_t *GetKeysMarshal(adb_GetKeys_t * getKeys, const axutil_env_
     adb_GetKeysResponse_set_GetKeysResponse(ret, env, response);
     return (ret);
 }
+
+//!
+//! Server side of the get log chunk service request
+//!
+//! @param[in] getLogChunk pointer to the request structure
+//! @param[in] env pointer to the AXIS2 environment
+//!
+//! @return A pointer to the response structure
+//!
+adb_GetLogChunkResponse_t *GetLogChunkMarshal(adb_GetLogChunk_t * getLogChunk, const axutil_env_t * env)
+{
+    int rc = 0;
+    axis2_bool_t status = AXIS2_TRUE;
+    char *userId = NULL;
+    char *correlationId = NULL;
+    char *service = NULL;
+    char *logName = NULL;
+    char statusMessage[256] = { 0 };
+    logChunk chunk = { {0} };
+    adb_GetLogChunkResponse_t *ret = NULL;
+    adb_getLogChunkResponseType_t *response = NULL;
+    adb_getLogChunkType_t *request = NULL;
+
+    request = adb_GetLogChunk_get_GetLogChunk(getLogChunk, env);
+    userId = adb_getLogChunkType_get_userId(request, env);
+    correlationId = adb_getLogChunkType_get_correlationId(request, env);
+    service = adb_getLogChunkType_get_serviceTag(request, env);
+    logName = adb_getLogChunkType_get_logName(request, env);
+    response = adb_getLogChunkResponseType_create(env);
+
+    if ((rc = doGetLogChunk(service, logName, adb_getLogChunkType_get_offset(request, env), adb_getLogChunkType_get_maxBytes(request, env),
+                            adb_getLogChunkType_get_since(request, env), adb_getLogChunkType_get_until(request, env), adb_getLogChunkType_get_level(request, env),
+                            adb_getLogChunkType_get_follow(request, env), &chunk)) != EUCA_OK) {
+        status = AXIS2_FALSE;
+        snprintf(statusMessage, 255, "ERROR");
+    } else {
+        adb_getLogChunkResponseType_set_encoding(response, env, chunk.encoding);
+        if (chunk.data) {
+            adb_getLogChunkResponseType_set_data(response, env, chunk.data);
+            EUCA_FREE(chunk.data);
+        }
+        adb_getLogChunkResponseType_set_dataLength(response, env, chunk.dataLength);
+        adb_getLogChunkResponseType_set_nextOffset(response, env, chunk.nextOffset);
+        adb_getLogChunkResponseType_set_fileSize(response, env, chunk.fileSize);
+    }
+
+    adb_getLogChunkResponseType_set_serviceTag(response, env, service);
+    adb_getLogChunkResponseType_set_logName(response, env, logName);
+    adb_getLogChunkResponseType_set_userId(response, env, userId);
+    adb_getLogChunkResponseType_set_correlationId(response, env, correlationId);
+    adb_getLogChunkResponseType_set_return(response, env, status);
+    if (status == AXIS2_FALSE) {
+        adb_getLogChunkResponseType_set_statusMessage(response, env, statusMessage);
+    }
+
+    ret = adb_GetLogChunkResponse_create(env);
+    adb_GetLogChunkResponse_set_GetLogChunkResponse(ret, env, response);
+    return (ret);
+}
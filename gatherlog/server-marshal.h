@@ -118,6 +118,7 @@
 
 //adb_GetLogsResponse_t *GetLogsMarshal(adb_GetLogs_t * getLogs, const axutil_env_t * env);
 adb_GetKeysResponse_t *GetKeysMarshal(adb_GetKeys_t * getKeys, const axutil_env_t * env);
+adb_GetLogChunkResponse_t *GetLogChunkMarshal(adb_GetLogChunk_t * getLogChunk, const axutil_env_t * env);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -122,6 +122,7 @@ enum {
     EUCANETD_CVAL_MIDOGWIFACE,
     EUCANETD_CVAL_MIDOPUBNW,
     EUCANETD_CVAL_MIDOPUBGWIP,
+    EUCANETD_CVAL_FIREWALL_BACKEND,
     EUCANETD_CVAL_LAST,
 };
 
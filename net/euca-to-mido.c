@@ -7,6 +7,7 @@
 #include <pwd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ctype.h>
 #include <curl/curl.h>
 #include <json/json.h>
@@ -27,6 +28,7 @@
 #include "globalnetwork.h"
 #include "midonet-api.h"
 #include "euca-to-mido.h"
+#include "metaproxy.h"
 
 int do_metaproxy_teardown(mido_config * mido)
 {
@@ -39,11 +41,65 @@ int do_metaproxy_setup(mido_config * mido)
     return (do_metaproxy_maintain(mido, 0));
 }
 
+//!
+//! Stops the nginx metadata proxies eucanetd used to run, one in each VPC namespace and a core
+//! one, so their ports are free for the proxy that replaces them. Only needed once per eucanetd.
+//!
+//! @param[in] mido
+//! @param[in] cmds where to add the commands that stop them
+//!
+static void stop_nginx_metaproxies(mido_config * mido, sequence_executor * cmds)
+{
+    pid_t npid = 0;
+    char rundir[EUCA_MAX_PATH], pidfile[EUCA_MAX_PATH], cmd[EUCA_MAX_PATH], *pidstr = NULL;
+    DIR *DH = NULL;
+    struct dirent *dent = NULL;
+
+    snprintf(rundir, EUCA_MAX_PATH, "%s/var/run/eucalyptus", mido->eucahome);
+    if ((DH = opendir(rundir)) == NULL) {
+        return;
+    }
+
+    while ((dent = readdir(DH)) != NULL) {
+        if (strcmp(dent->d_name, "nginx_localproxy.pid") && strncmp(dent->d_name, "nginx_vpcproxy_", 15)) {
+            continue;
+        }
+
+        snprintf(pidfile, EUCA_MAX_PATH, "%s/%s", rundir, dent->d_name);
+        npid = 0;
+        if ((pidstr = file2str(pidfile)) != NULL) {
+            npid = atoi(pidstr);
+            EUCA_FREE(pidstr);
+        }
+
+        if (npid > 1 && !check_process(npid, "nginx")) {
+            LOGINFO("stopping nginx metadata proxy (%s) pid (%d)\n", dent->d_name, npid);
+            snprintf(cmd, EUCA_MAX_PATH, "kill %d", npid);
+            se_add(cmds, cmd, NULL, ignore_exit);
+        }
+        unlink(pidfile);
+    }
+    closedir(DH);
+}
+
+//!
+//! Keeps the metadata proxy of the VPCs running (mode 0) or stops it (mode 1). A single
+//! eucanetd-metaproxy process listens in the namespaces of all the VPCs, the ones listed in
+//! METAPROXY_VPCS_FILE, so maintaining it is a matter of rewriting the list when the VPCs
+//! change and of one liveness check of the process.
+//!
+//! @param[in] mido
+//! @param[in] mode 0 to set up, 1 to tear down
+//!
+//! @return 0 on success or 1 on failure
+//!
 int do_metaproxy_maintain(mido_config * mido, int mode)
 {
     int ret = 0, rc = 0, i = 0, dorun = 0;
     pid_t npid = 0;
-    char rr[EUCA_MAX_PATH], cmd[EUCA_MAX_PATH], *pidstr = NULL, pidfile[EUCA_MAX_PATH];
+    char rr[EUCA_MAX_PATH], cmd[EUCA_MAX_PATH], *pidstr = NULL, pidfile[EUCA_MAX_PATH], vpcsfile[EUCA_MAX_PATH], tmpfile[EUCA_MAX_PATH];
+    char *vpcs = NULL, *oldvpcs = NULL, line[32];
+    static int nginx_stopped = 0;
     sequence_executor cmds;
 
     if (!mido || mode < 0 || mode > 1) {
@@ -55,24 +111,55 @@ int do_metaproxy_maintain(mido_config * mido, int mode)
 
     rc = se_init(&cmds, rr, 2, 1);
 
+    if (!nginx_stopped) {
+        stop_nginx_metaproxies(mido, &cmds);
+        nginx_stopped = 1;
+    }
+
+    // the proxy picks up a new list on its own, so only write one when the VPCs changed
+    snprintf(vpcsfile, EUCA_MAX_PATH, METAPROXY_VPCS_FILE, mido->eucahome);
+    if (mode == 0) {
+        vpcs = strdup("");
+        for (i = 0; i < mido->max_vpcs && vpcs; i++) {
+            if (strlen(mido->vpcs[i].name) && mido->vpcs[i].gnipresent) {
+                snprintf(line, sizeof(line), "%s\n", mido->vpcs[i].name);
+                vpcs = euca_strdupcat(vpcs, line);
+            }
+        }
+
+        oldvpcs = file2str(vpcsfile);
+        if (vpcs && (!oldvpcs || strcmp(vpcs, oldvpcs))) {
+            LOGDEBUG("VPCs changed, updating metadata proxy list (%s)\n", vpcsfile);
+            snprintf(tmpfile, EUCA_MAX_PATH, "%s.tmp", vpcsfile);
+            if (str2file(vpcs, tmpfile, (O_CREAT | O_WRONLY | O_TRUNC), 0644, FALSE) != EUCA_OK || rename(tmpfile, vpcsfile)) {
+                LOGERROR("could not write metadata proxy list (%s): check permissions\n", vpcsfile);
+                unlink(tmpfile);
+                ret = 1;
+            }
+        }
+        EUCA_FREE(oldvpcs);
+        EUCA_FREE(vpcs);
+    } else {
+        unlink(vpcsfile);
+    }
+
     dorun = 0;
-    snprintf(pidfile, EUCA_MAX_PATH, "%s/var/run/eucalyptus/nginx_localproxy.pid", mido->eucahome);
+    snprintf(pidfile, EUCA_MAX_PATH, METAPROXY_PIDFILE, mido->eucahome);
     if (!check_file(pidfile)) {
-      pidstr = file2str(pidfile);
-      if (pidstr) {
-        npid = atoi(pidstr);
-      } else {
-        npid = 0;
-      }
-      EUCA_FREE(pidstr);
+        pidstr = file2str(pidfile);
+        if (pidstr) {
+            npid = atoi(pidstr);
+        } else {
+            npid = 0;
+        }
+        EUCA_FREE(pidstr);
     } else {
-      npid = 0;
+        npid = 0;
     }
 
-
     if (mode == 0) {
         if (npid > 1) {
-            if (check_process(npid, "nginx")) {
+            if (check_process(npid, "eucanetd-metaproxy")) {
                 unlink(pidfile);
                 dorun = 1;
             }
@@ -80,78 +167,28 @@ int do_metaproxy_maintain(mido_config * mido, int mode)
             dorun = 1;
         }
     } else if (mode == 1) {
-        if (npid > 1 && !check_process(npid, "nginx")) {
+        if (npid > 1 && !check_process(npid, "eucanetd-metaproxy")) {
             dorun = 1;
         }
     }
 
     if (dorun) {
         if (mode == 0) {
-            LOGDEBUG("core proxy not running, starting new core proxy\n");
-            snprintf(cmd, EUCA_MAX_PATH,
-                     "nginx -p . -c %s/usr/share/eucalyptus/nginx_proxy.conf -g 'pid %s/var/run/eucalyptus/nginx_localproxy.pid; env NEXTHOP=127.0.0.1; env NEXTHOPPORT=8773; env EUCAHOME=%s;'",
-                     mido->eucahome, mido->eucahome, mido->eucahome);
+            LOGDEBUG("metadata proxy not running, starting new metadata proxy\n");
+            snprintf(cmd, EUCA_MAX_PATH, METAPROXY_BINARY " -n %s -p %d %s", mido->eucahome, METAPROXY_NEXTHOP, METAPROXY_NEXTHOP_PORT, mido->eucahome);
         } else if (mode == 1) {
-            LOGDEBUG("core proxy running, terminating core proxy\n");
+            LOGDEBUG("metadata proxy running, terminating metadata proxy\n");
             snprintf(cmd, EUCA_MAX_PATH, "kill %d", npid);
         }
         rc = se_add(&cmds, cmd, NULL, ignore_exit);
     } else {
-        LOGDEBUG("not maintaining proxy, no action to take for pid (%d)\n", npid);
-    }
-
-    for (i = 0; i < mido->max_vpcs; i++) {
-        if (strlen(mido->vpcs[i].name)) {
-            dorun = 0;
-            snprintf(pidfile, EUCA_MAX_PATH, "%s/var/run/eucalyptus/nginx_vpcproxy_%s.pid", mido->eucahome, mido->vpcs[i].name);
-	    if (!check_file(pidfile)) {
-	      pidstr = file2str(pidfile);
-	      if (pidstr) {
-                npid = atoi(pidstr);
-	      } else {
-                npid = 0;
-	      }
-	      EUCA_FREE(pidstr);
-	    } else {
-	      npid = 0;
-	    }
-
-            if (mode == 0) {
-                if (npid > 1) {
-                    if (check_process(npid, "nginx")) {
-                        unlink(pidfile);
-                        dorun = 1;
-                    }
-                } else {
-                    dorun = 1;
-                }
-            } else if (mode == 1) {
-                if (npid > 1 && !check_process(npid, "nginx")) {
-                    dorun = 1;
-                }
-            }
-
-            if (dorun) {
-                if (mode == 0) {
-                    LOGDEBUG("VPC (%s) proxy not running, starting new proxy\n", mido->vpcs[i].name);
-                    snprintf(cmd, EUCA_MAX_PATH,
-                             "ip netns exec %s nginx -p . -c %s/usr/share/eucalyptus/nginx_proxy.conf -g 'pid %s/var/run/eucalyptus/nginx_vpcproxy_%s.pid; env VPCID=%s; env NEXTHOP=169.254.0.1; env NEXTHOPPORT=31338; env EUCAHOME=%s;'",
-                             mido->vpcs[i].name, mido->eucahome, mido->eucahome, mido->vpcs[i].name, mido->vpcs[i].name, mido->eucahome);
-                } else if (mode == 1) {
-                    LOGDEBUG("VPC (%s) proxy running, terminating VPC proxy\n", mido->vpcs[i].name);
-                    snprintf(cmd, EUCA_MAX_PATH, "kill %d", npid);
-                }
-                rc = se_add(&cmds, cmd, NULL, ignore_exit);
-            } else {
-                LOGDEBUG("not maintaining VPC (%s) proxy, no action to take on pid (%d)\n", mido->vpcs[i].name, npid);
-            }
-        }
+        LOGDEBUG("not maintaining metadata proxy, no action to take for pid (%d)\n", npid);
     }
 
     se_print(&cmds);
     rc = se_execute(&cmds);
     if (rc) {
-        LOGERROR("could not execute meta core bridge setup/proxy commands: see above log entries for details\n");
+        LOGERROR("could not execute metadata proxy commands: see above log entries for details\n");
         ret = 1;
     }
     se_free(&cmds);
@@ -561,9 +598,192 @@ int do_midonet_teardown(mido_config * mido)
     return (ret);
 }
 
-int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
+//!
+//! Clears the marks left on the local mirror by the previous update, so that whatever the
+//! new network info no longer holds can be found and torn down
+//!
+//! @param[in] mido the mirror
+//!
+static void mido_clear_gnipresent(mido_config * mido)
+{
+    int i = 0, j = 0, k = 0;
+
+    for (i = 0; i < mido->max_vpcsecgroups; i++) {
+        mido->vpcsecgroups[i].gnipresent = 0;
+    }
+    for (i = 0; i < mido->max_vpcs; i++) {
+        mido->vpcs[i].gnipresent = 0;
+        for (j = 0; j < mido->vpcs[i].max_subnets; j++) {
+            mido->vpcs[i].subnets[j].gnipresent = 0;
+            for (k = 0; k < mido->vpcs[i].subnets[j].max_instances; k++) {
+                mido->vpcs[i].subnets[j].instances[k].gnipresent = 0;
+            }
+        }
+    }
+}
+
+//!
+//! Tells whether an instance needs its MidoNet objects redone, or whether what the local mirror
+//! holds for it can be kept as is
+//!
+//! @param[in] mido the mirror
+//! @param[in] delta the changes since the mirror was last brought up to date
+//! @param[in] gniinstance the instance
+//!
+//! @return 1 if the instance or one of its sec. groups changed, or a sec. group is missing from the mirror, or 0 otherwise
+//!
+static int mido_instance_changed(mido_config * mido, gni_delta * delta, gni_instance * gniinstance)
+{
+    int i = 0;
+    mido_vpc_secgroup *vpcsecgroup = NULL;
+
+    if (gni_delta_has_instance(delta, gniinstance->name)) {
+        return (1);
+    }
+    for (i = 0; i < gniinstance->max_secgroup_names; i++) {
+        vpcsecgroup = NULL;
+        find_mido_vpc_secgroup(mido, gniinstance->secgroup_names[i].name, &vpcsecgroup);
+        if (!vpcsecgroup || gni_delta_has_secgroup(delta, gniinstance->secgroup_names[i].name)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+//!
+//! Brings the IP address groups and the ingress chain of a sec. group in line with the network
+//! info: the groups get the addresses of the VPC instances in the sec. group, the chain gets one
+//! accept rule per ingress rule. Each is read from MidoNet once and only what differs is written.
+//!
+//! @param[in] gni the network info
+//! @param[in] mido the mirror
+//! @param[in] vpcsecgroup the sec. group, with gniSecgroup set
+//!
+//! @return 0 on success or 1 if any of the groups or the chain could not be brought in line
+//!
+static int sync_mido_vpc_secgroup(globalNetworkInfo * gni, mido_config * mido, mido_vpc_secgroup * vpcsecgroup)
+{
+    int ret = 0, i = 0, max_privips = 0, max_pubips = 0, max_allips = 0, max_rules = 0;
+    char **privips = NULL, **pubips = NULL, **allips = NULL, **rules = NULL, *tmpstr = NULL;
+    char fromport[32], toport[32], proto[32], srcnet[24], srcslashnet[8], *srcaddr = NULL, *srclen = NULL;
+    gni_secgroup *gnisecgroup = vpcsecgroup->gniSecgroup;
+    gni_instance *gniinstance = NULL;
+    gni_rule *rule = NULL;
+    mido_vpc_secgroup *srcsecgroup = NULL;
+
+    privips = EUCA_ZALLOC(gnisecgroup->max_instance_names + 1, sizeof(char *));
+    pubips = EUCA_ZALLOC(gnisecgroup->max_instance_names + 1, sizeof(char *));
+    allips = EUCA_ZALLOC((2 * gnisecgroup->max_instance_names) + 1, sizeof(char *));
+    rules = EUCA_ZALLOC(gnisecgroup->max_ingress_rules + 1, sizeof(char *));
+    if (!privips || !pubips || !allips || !rules) {
+        LOGERROR("out of memory\n");
+        ret = 1;
+        goto done;
+    }
+
+    // the addresses of the VPC instances in the sec. group
+    for (i = 0; i < gnisecgroup->max_instance_names; i++) {
+        gniinstance = gni_find_instance(gni, gnisecgroup->instance_names[i].name);
+        if (!gniinstance || !strlen(gniinstance->vpc)) {
+            continue;
+        }
+
+        tmpstr = hex2dot(gniinstance->privateIp);
+        privips[max_privips++] = tmpstr;
+        allips[max_allips++] = tmpstr;
+
+        tmpstr = hex2dot(gniinstance->publicIp);
+        if (tmpstr && strcmp(tmpstr, "0.0.0.0")) {
+            pubips[max_pubips++] = tmpstr;
+            allips[max_allips++] = tmpstr;
+        } else {
+            EUCA_FREE(tmpstr);
+        }
+    }
+
+    // one accept rule per ingress rule
+    for (i = 0; i < gnisecgroup->max_ingress_rules; i++) {
+        rule = &(gnisecgroup->ingress_rules[i]);
+        snprintf(proto, 32, "%d", rule->protocol);
+
+        srcaddr = srclen = "UNSET";
+        if (strlen(rule->cidr) && strcmp(rule->cidr, "0.0.0.0/0")) {
+            srcnet[0] = srcslashnet[0] = '\0';
+            cidr_split(rule->cidr, srcnet, srcslashnet, NULL, NULL);
+            if (strlen(srcnet) && strlen(srcslashnet)) {
+                srcaddr = srcnet;
+                srclen = srcslashnet;
+            }
+        }
+
+        if (strlen(rule->groupId)) {
+            // traffic from the instances of another sec. group
+            srcsecgroup = NULL;
+            find_mido_vpc_secgroup(mido, rule->groupId, &srcsecgroup);
+            if (!srcsecgroup || !srcsecgroup->midos[VPCSG_IAGALL].init) {
+                LOGWARN("sec. group %s refers to sec. group %s, which is not in midonet yet: skipping rule\n", vpcsecgroup->name, rule->groupId);
+                continue;
+            }
+            rules[max_rules] = mido_jsonize_args(NULL, "type", "accept", "ipAddrGroupSrc", srcsecgroup->midos[VPCSG_IAGALL].uuid, NULL);
+        } else if (rule->protocol == 6 || rule->protocol == 17) {
+            // TCP/UDP
+            snprintf(fromport, 32, "%d", rule->fromPort);
+            snprintf(toport, 32, "%d", rule->toPort);
+            rules[max_rules] = mido_jsonize_args(NULL, "type", "accept", "tpDst", "jsonjson", "tpDst:start", fromport, "tpDst:end", toport, "tpDst:END", "END",
+                                                 "nwProto", proto, "nwSrcAddress", srcaddr, "nwSrcLength", srclen, NULL);
+        } else if (rule->protocol == 1) {
+            // ICMP
+            if (rule->icmpCode >= 0) {
+                snprintf(fromport, 32, "%d", rule->icmpCode);
+                rules[max_rules] = mido_jsonize_args(NULL, "type", "accept", "tpDst", "jsonjson", "tpDst:start", fromport, "tpDst:end", fromport, "tpDst:END", "END",
+                                                     "nwProto", proto, "nwSrcAddress", srcaddr, "nwSrcLength", srclen, NULL);
+            } else {
+                // its the all rule
+                rules[max_rules] = mido_jsonize_args(NULL, "type", "accept", "nwProto", proto, "nwSrcAddress", srcaddr, "nwSrcLength", srclen, NULL);
+            }
+        } else {
+            // TODO other protos?
+            continue;
+        }
+        if (rules[max_rules]) {
+            max_rules++;
+        }
+    }
+
+    if (mido_sync_ipaddrgroup_ips(&(vpcsecgroup->midos[VPCSG_IAGPRIV]), privips, max_privips)) {
+        ret = 1;
+    }
+    if (mido_sync_ipaddrgroup_ips(&(vpcsecgroup->midos[VPCSG_IAGPUB]), pubips, max_pubips)) {
+        ret = 1;
+    }
+    if (mido_sync_ipaddrgroup_ips(&(vpcsecgroup->midos[VPCSG_IAGALL]), allips, max_allips)) {
+        ret = 1;
+    }
+    if (mido_sync_rules(&(vpcsecgroup->midos[VPCSG_INGRESS]), rules, max_rules)) {
+        ret = 1;
+    }
+
+done:
+    // the strings in allips are the ones in privips and pubips
+    for (i = 0; privips && (i < max_privips); i++) {
+        EUCA_FREE(privips[i]);
+    }
+    for (i = 0; pubips && (i < max_pubips); i++) {
+        EUCA_FREE(pubips[i]);
+    }
+    for (i = 0; rules && (i < max_rules); i++) {
+        EUCA_FREE(rules[i]);
+    }
+    EUCA_FREE(privips);
+    EUCA_FREE(pubips);
+    EUCA_FREE(allips);
+    EUCA_FREE(rules);
+    return (ret);
+}
+
+int do_midonet_update(globalNetworkInfo * gni, gni_delta * delta, mido_config * mido)
 {
-    int i = 0, j = 0, k = 0, rc = 0;
+    int i = 0, j = 0, k = 0, rc = 0, incremental = 0, missing = 0;
     char subnet_buf[24], slashnet_buf[8], gw_buf[24], pt_buf[24];
     mido_vpc_secgroup *vpcsecgroup = NULL;
     mido_vpc_instance *vpcinstance = NULL;
@@ -576,11 +796,21 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
 
     mido->enabledCLCIp = gni->enabledCLCIp;
 
-    rc = do_midonet_populate(mido);
-    if (rc) {
-        LOGERROR("could not populate prior to update: see above log entries for details\n");
-        return (1);
+    // with a delta and a mirror that matched MidoNet after the last update, only the instances and
+    // sec. groups that changed generate REST traffic; anything else rebuilds the mirror first
+    incremental = (delta && !delta->full && !delta->config_changed && mido->populated);
+    if (incremental) {
+        LOGDEBUG("applying changes to the local midonet mirror\n");
+        mido_clear_gnipresent(mido);
+    } else {
+        rc = do_midonet_populate(mido);
+        if (rc) {
+            LOGERROR("could not populate prior to update: see above log entries for details\n");
+            return (1);
+        }
+        mido->populated_at = time(NULL);
     }
+    mido->populated = 0;
     // temporary print
     LOGDEBUG("TOTAL SEC. GROUPS: %d\n", mido->max_vpcsecgroups);
     for (i = 0; i < mido->max_vpcsecgroups; i++) {
@@ -615,6 +845,24 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
         LOGINFO("initializing VPC '%s' with '%d' subnets\n", gnivpc->name, gnivpc->max_subnets);
 
         rc = find_mido_vpc(mido, gnivpc->name, &vpc);
+        if (vpc && incremental) {
+            // the VPCs are unchanged or this would not be an incremental update, so unless the mirror
+            // is missing a subnet there is nothing to create
+            for (j = 0, missing = 0; j < gnivpc->max_subnets; j++) {
+                rc = find_mido_vpc_subnet(vpc, gnivpc->subnets[j].name, &vpcsubnet);
+                if (vpcsubnet) {
+                    vpcsubnet->gniSubnet = &(gnivpc->subnets[j]);
+                    vpcsubnet->gnipresent = 1;
+                } else {
+                    missing = 1;
+                }
+            }
+            if (!missing) {
+                vpc->gnipresent = 1;
+                continue;
+            }
+        }
+
         if (vpc) {
             LOGINFO("found gni VPC '%s' already extant\n", gnivpc->name);
         } else {
@@ -668,11 +916,13 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
     // should do sec. group populate/create loop
 
     // now do instance interface mappings
+    // written aside and moved in place, so the metadata proxy never reads half a map
     FILE *PFH = NULL;
-    char mapfile[EUCA_MAX_PATH];
-    snprintf(mapfile, EUCA_MAX_PATH, "%s/var/run/eucalyptus/eucanetd_vpc_instance_ip_map", mido->eucahome);
-    unlink(mapfile);
-    PFH = fopen(mapfile, "w");
+    char mapfile[EUCA_MAX_PATH], tmpmapfile[EUCA_MAX_PATH];
+    snprintf(mapfile, EUCA_MAX_PATH, METAPROXY_INSTANCE_MAP_FILE, mido->eucahome);
+    snprintf(tmpmapfile, EUCA_MAX_PATH, "%s.tmp", mapfile);
+    unlink(tmpmapfile);
+    PFH = fopen(tmpmapfile, "w");
 
     for (i = 0; i < gni->max_instances; i++) {
         gni_instance *gniinstance = &(gni->instances[i]);
@@ -689,12 +939,32 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
                     if (vpcinstance) {
                         LOGDEBUG("found instance '%s' is in extant vpc '%s' subnet '%s' '%d'\n", vpcinstance->name, vpc->name, vpcsubnet->name, vpcinstance->midos[VMHOST].init);
                         vpcinstance->gniInst = gniinstance;
+                        if (incremental && !mido_instance_changed(mido, delta, gniinstance)) {
+                            // nothing to redo, but the instance and its sec. groups are still in use
+                            vpcinstance->gnipresent = 1;
+                            for (j = 0; j < gniinstance->max_secgroup_names; j++) {
+                                rc = find_mido_vpc_secgroup(mido, gniinstance->secgroup_names[j].name, &vpcsecgroup);
+                                if (vpcsecgroup) {
+                                    vpcsecgroup->gniSecgroup = gni_find_secgroup(gni, gniinstance->secgroup_names[j].name);
+                                    vpcsecgroup->gnipresent = 1;
+                                }
+                            }
+
+                            char *privIp = NULL;
+                            privIp = hex2dot(gniinstance->privateIp);
+                            fprintf(PFH, "%s %s %s\n", vpc->name, vpcinstance->name, privIp);
+                            EUCA_FREE(privIp);
+                            continue;
+                        }
                     } else {
-                        // create the instance
-                        vpcsubnet->instances = realloc(vpcsubnet->instances, sizeof(mido_vpc_instance) * (vpcsubnet->max_instances + 1));
-                        vpcinstance = &(vpcsubnet->instances[vpcsubnet->max_instances]);
+                        // create the instance, in the slot of one torn down earlier if there is one
+                        rc = find_mido_vpc_instance(vpcsubnet, "", &vpcinstance);
+                        if (!vpcinstance) {
+                            vpcsubnet->instances = realloc(vpcsubnet->instances, sizeof(mido_vpc_instance) * (vpcsubnet->max_instances + 1));
+                            vpcinstance = &(vpcsubnet->instances[vpcsubnet->max_instances]);
+                            vpcsubnet->max_instances++;
+                        }
                         bzero(vpcinstance, sizeof(mido_vpc_instance));
-                        vpcsubnet->max_instances++;
                         snprintf(vpcinstance->name, 16, "%s", gniinstance->name);
                         vpcinstance->gniInst = gniinstance;
                     }
@@ -753,7 +1023,7 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
                     {
                         gni_secgroup *gnisecgroups = NULL;
                         int max_gnisecgroups, rulepos = 1;
-                        char tmp_name1[32], tmp_name2[32], tmp_name3[32], tmp_name4[32];
+                        char tmp_name3[32];
 
                         subnet_buf[0] = slashnet_buf[0] = gw_buf[0] = '\0';
                         cidr_split(vpcsubnet->gniSubnet->cidr, subnet_buf, slashnet_buf, gw_buf, pt_buf);
@@ -822,20 +1092,22 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
                         rc = gni_instance_get_secgroups(gni, gniinstance, NULL, 0, NULL, 0, &gnisecgroups, &max_gnisecgroups);
                         for (j = 0; j < max_gnisecgroups; j++) {
                             gni_secgroup *gnisecgroup = &(gnisecgroups[j]);
-                            char *tmpstr = NULL;
 
                             // create the SG
                             rc = find_mido_vpc_secgroup(mido, gnisecgroup->name, &vpcsecgroup);
                             if (vpcsecgroup) {
                                 // found one
-                                vpcsecgroup->gniSecgroup = gnisecgroup;
+                                vpcsecgroup->gniSecgroup = gni_find_secgroup(gni, gnisecgroup->name);
                             } else {
-                                mido->vpcsecgroups = realloc(mido->vpcsecgroups, sizeof(mido_vpc_secgroup) * (mido->max_vpcsecgroups + 1));
-                                vpcsecgroup = &(mido->vpcsecgroups[mido->max_vpcsecgroups]);
+                                rc = find_mido_vpc_secgroup(mido, "", &vpcsecgroup);
+                                if (!vpcsecgroup) {
+                                    mido->vpcsecgroups = realloc(mido->vpcsecgroups, sizeof(mido_vpc_secgroup) * (mido->max_vpcsecgroups + 1));
+                                    vpcsecgroup = &(mido->vpcsecgroups[mido->max_vpcsecgroups]);
+                                    mido->max_vpcsecgroups++;
+                                }
                                 bzero(vpcsecgroup, sizeof(mido_vpc_secgroup));
-                                mido->max_vpcsecgroups++;
                                 snprintf(vpcsecgroup->name, 16, "%s", gnisecgroup->name);
-                                vpcsecgroup->gniSecgroup = gnisecgroup;
+                                vpcsecgroup->gniSecgroup = gni_find_secgroup(gni, gnisecgroup->name);
                             }
 
                             LOGDEBUG("ABOUT TO CREATE SG '%s'\n", vpcsecgroup->name);
@@ -844,34 +1116,8 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
                                 // TODO
                             }
 
-                            tmpstr = hex2dot(gniinstance->privateIp);
-                            rc = mido_create_ipaddrgroup_ip(&(vpcsecgroup->midos[VPCSG_IAGPRIV]), tmpstr, NULL);
-                            rc = mido_create_ipaddrgroup_ip(&(vpcsecgroup->midos[VPCSG_IAGALL]), tmpstr, NULL);
-                            EUCA_FREE(tmpstr);
-
-                            tmpstr = hex2dot(gniinstance->publicIp);
-			    if (tmpstr && strcmp(tmpstr, "0.0.0.0")) {
-			      rc = mido_create_ipaddrgroup_ip(&(vpcsecgroup->midos[VPCSG_IAGPUB]), tmpstr, NULL);
-			      rc = mido_create_ipaddrgroup_ip(&(vpcsecgroup->midos[VPCSG_IAGALL]), tmpstr, NULL);
-			    }
-                            EUCA_FREE(tmpstr);
-
                             vpcsecgroup->gnipresent = 1;
 
-                            // TODO make this better (not entire clear/reset each time
-                            {
-                                midoname *rules = NULL;
-                                int max_rules = 0, r = 0;
-                                rc = mido_get_rules(&(vpcsecgroup->midos[VPCSG_INGRESS]), &rules, &max_rules);
-                                if (max_rules != gnisecgroup->max_ingress_rules) {
-                                    for (r = 0; r < max_rules; r++) {
-                                        mido_delete_rule(&(rules[r]));
-                                    }
-                                }
-                                mido_free_midoname_list(rules, max_rules);
-                                EUCA_FREE(rules);
-                            }
-
                             snprintf(tmp_name3, 32, "%d", rulepos);
                             rc = mido_create_rule(&(vpcinstance->midos[INST_POSTCHAIN]), NULL, "position", tmp_name3, "type", "jump", "jumpChainId",
                                                   vpcsecgroup->midos[VPCSG_INGRESS].uuid, NULL);
@@ -886,79 +1132,6 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
                             } else {
                                 rulepos++;
                             }
-
-                            rulepos = 1;
-                            for (k = 0; k < gnisecgroup->max_ingress_rules; k++) {
-                                // TODO other protos?
-                                // TODO add ingress from other SGs (set up IAGs and such)
-
-                                snprintf(tmp_name4, 32, "%d", gnisecgroup->ingress_rules[k].protocol);
-                                if (strlen(gnisecgroup->ingress_rules[k].groupId)) {
-                                    // other group
-                                    midoname *midos = NULL;
-                                    int max_midos = 0, r;
-                                    char name[32], *mname = NULL;
-                                    int found = 0;
-                                    rc = mido_get_ipaddrgroups("euca_tenant_1", &midos, &max_midos);
-                                    for (r = 0; r < max_midos && !found; r++) {
-                                        snprintf(name, 32, "sg_all_%11s", vpcsecgroup->name);
-                                        rc = mido_getel_midoname(&(midos[r]), "name", &mname);
-                                        if (mname && !strcmp(name, mname)) {
-                                            LOGTRACE("FOUND: %s/%s\n", mname, midos[r].uuid);
-                                            snprintf(tmp_name3, 32, "%d", rulepos);
-                                            rc = mido_create_rule(&(vpcsecgroup->midos[VPCSG_INGRESS]), NULL, "position", tmp_name3, "type", "accept", "ipAddrGroupSrc",
-                                                                  midos[r].uuid, NULL);
-                                            if (rc) {
-                                            } else {
-                                                rulepos++;
-                                            }
-                                            found++;
-                                        }
-                                        EUCA_FREE(mname);
-                                    }
-                                    mido_free_midoname_list(midos, max_midos);
-                                    EUCA_FREE(midos)
-                                } else if (gnisecgroup->ingress_rules[k].protocol == 6 || gnisecgroup->ingress_rules[k].protocol == 17) {
-                                    // TCP/UDP
-
-                                    snprintf(tmp_name1, 32, "%d", gnisecgroup->ingress_rules[k].fromPort);
-                                    snprintf(tmp_name2, 32, "%d", gnisecgroup->ingress_rules[k].toPort);
-
-                                    snprintf(tmp_name3, 32, "%d", rulepos);
-                                    rc = mido_create_rule(&(vpcsecgroup->midos[VPCSG_INGRESS]), NULL, "position", tmp_name3, "type", "accept", "tpDst", "jsonjson", "tpDst:start",
-                                                          tmp_name1, "tpDst:end", tmp_name2, "tpDst:END", "END", "nwProto", tmp_name4, NULL);
-                                    if (rc) {
-                                    } else {
-                                        rulepos++;
-                                    }
-
-                                } else if (gnisecgroup->ingress_rules[k].protocol == 1) {
-                                    // ICMP
-
-                                    snprintf(tmp_name3, 32, "%d", rulepos);
-
-                                    if (gnisecgroup->ingress_rules[k].icmpCode >= 0) {
-                                        snprintf(tmp_name1, 32, "%d", gnisecgroup->ingress_rules[k].icmpCode);
-                                        //          rc = mido_create_rule(&(vpcinstance->midos[INST_POSTCHAIN]), NULL, "position", tmp_name3, "type", "accept", "tpDst", "jsonjson", "tpDst:start", tmp_name1, "tpDst:end", tmp_name1, "tpDst:END", "END", "nwProto", tmp_name4, NULL);
-                                        rc = mido_create_rule(&(vpcsecgroup->midos[VPCSG_INGRESS]), NULL, "position", tmp_name3, "type", "accept", "tpDst", "jsonjson",
-                                                              "tpDst:start", tmp_name1, "tpDst:end", tmp_name1, "tpDst:END", "END", "nwProto", tmp_name4, NULL);
-                                        if (rc) {
-                                        } else {
-                                            rulepos++;
-                                        }
-                                    } else {
-                                        // its the all rule
-                                        //          rc = mido_create_rule(&(vpcinstance->midos[INST_POSTCHAIN]), NULL, "position", tmp_name3, "type", "accept", "nwProto", tmp_name4, NULL);
-                                        rc = mido_create_rule(&(vpcsecgroup->midos[VPCSG_INGRESS]), NULL, "position", tmp_name3, "type", "accept", "nwProto", tmp_name4, NULL);
-                                        if (rc) {
-                                        } else {
-                                            rulepos++;
-                                        }
-                                    }
-
-                                }
-                            }
-
                         }
                         EUCA_FREE(gnisecgroups);
 
@@ -970,6 +1143,25 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
         }
     }
     fclose(PFH);
+    if (rename(tmpmapfile, mapfile)) {
+        LOGERROR("could not move VPC instance map (%s) in place: check permissions\n", mapfile);
+    }
+
+    // with the instances in place, bring the address groups and ingress chain of each sec. group in use in line
+    for (i = 0; i < mido->max_vpcsecgroups; i++) {
+        vpcsecgroup = &(mido->vpcsecgroups[i]);
+        if (!strlen(vpcsecgroup->name) || !vpcsecgroup->gnipresent || !vpcsecgroup->gniSecgroup) {
+            continue;
+        }
+        if (incremental && !gni_delta_has_secgroup(delta, vpcsecgroup->name) && !delta->max_added_instances && !delta->max_removed_instances
+            && !delta->max_modified_instances) {
+            continue;
+        }
+        rc = sync_mido_vpc_secgroup(gni, mido, vpcsecgroup);
+        if (rc) {
+            LOGERROR("could not bring VPC sec. group %s in line: check midonet health\n", vpcsecgroup->name);
+        }
+    }
 
     // temporary print
     for (i = 0; i < mido->max_vpcs; i++) {
@@ -992,7 +1184,7 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
     for (i = 0; i < mido->max_vpcsecgroups; i++) {
         vpcsecgroup = &(mido->vpcsecgroups[i]);
         LOGDEBUG("CHECK: %s/%d\n", vpcsecgroup->name, vpcsecgroup->gnipresent);
-        if (!vpcsecgroup->gnipresent) {
+        if (strlen(vpcsecgroup->name) && !vpcsecgroup->gnipresent) {
             LOGINFO("tearing down VPC sec. group %s\n", vpcsecgroup->name);
             rc = delete_mido_vpc_secgroup(vpcsecgroup);
         }
@@ -1010,25 +1202,19 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
             for (k = 0; k < vpcsubnet->max_instances; k++) {
                 vpcinstance = &(vpcsubnet->instances[k]);
                 LOGDEBUG("\t\tCHECK: %s/%d\n", vpcinstance->name, vpcinstance->gnipresent);
-                if (!vpc->gnipresent || !vpcsubnet->gnipresent || !vpcinstance->gnipresent) {
+                if (strlen(vpcinstance->name) && (!vpc->gnipresent || !vpcsubnet->gnipresent || !vpcinstance->gnipresent)) {
                     rc = delete_mido_vpc_instance(vpcinstance);
                 }
             }
-            if (!vpc->gnipresent || !vpcsubnet->gnipresent) {
+            if (strlen(vpcsubnet->name) && (!vpc->gnipresent || !vpcsubnet->gnipresent)) {
                 LOGINFO("tearing down VPC '%s' subnet '%s'\n", vpc->name, vpcsubnet->name);
                 rc = delete_mido_vpc_subnet(mido, vpcsubnet);
             }
         }
-        if (!vpc->gnipresent) {
+        if (strlen(vpc->name) && !vpc->gnipresent) {
             LOGINFO("tearing down VPC '%s'\n", vpc->name);
 
-            rc = do_metaproxy_teardown(mido);
-            if (rc) {
-                // TODO
-                LOGERROR("cannot teardown metadata proxies: see above log for details\n");
-                // ret=1;
-            }
-
+            // the metadata proxy lets go of the VPC namespace once do_metaproxy_setup() below no longer lists it
             rc = delete_mido_vpc(mido, vpc);
         }
 
@@ -1040,6 +1226,7 @@ int do_midonet_update(globalNetworkInfo * gni, mido_config * mido)
         //    ret = 1;
     }
 
+    mido->populated = 1;
     return (0);
 }
 
@@ -1679,25 +1866,22 @@ int discover_mido_resources(mido_config * mido)
         LOGWARN("no routers in midonet\n");
     }
 
-    count = 0;
-    for (i = 0; i < mido->max_routers; i++) {
-        //      mido_get_ports(&(vpcsubnet->midos[VPCBR]), &(vpcsubnet->brports), &(vpcsubnet->max_brports));
-        rc = mido_get_ports(&(mido->routers[i]), &ports, &max_ports);
-        if (!rc && max_ports) {
-            mido->rtports = realloc(mido->rtports, sizeof(midoname) * (mido->max_rtports + max_ports));
-            for (j = 0; j < max_ports; j++) {
-                bzero(&(mido->rtports[count]), sizeof(midoname));
-                mido_copy_midoname(&(mido->rtports[count]), &(ports[j]));
-                count++;
-            }
-            mido->max_rtports += max_ports;
-        }
-
-        if (ports && max_ports > 0) {
-            mido_free_midoname_list(ports, max_ports);
-            EUCA_FREE(ports);
+    // all the router ports are read in one parallel round of requests rather than a router at a time
+    rc = mido_get_ports_all(mido->routers, mido->max_routers, &ports, &max_ports);
+    if (rc) {
+        LOGWARN("could not read the ports of some routers\n");
+    }
+    if (ports && max_ports > 0) {
+        count = mido->max_rtports;
+        mido->rtports = realloc(mido->rtports, sizeof(midoname) * (mido->max_rtports + max_ports));
+        for (j = 0; j < max_ports; j++) {
+            bzero(&(mido->rtports[count]), sizeof(midoname));
+            mido_copy_midoname(&(mido->rtports[count]), &(ports[j]));
+            count++;
         }
-
+        mido->max_rtports += max_ports;
+        mido_free_midoname_list(ports, max_ports);
+        EUCA_FREE(ports);
     }
 
     ports = NULL;
@@ -1707,23 +1891,22 @@ int discover_mido_resources(mido_config * mido)
     if (rc) {
         LOGWARN("no bridges in midonet\n");
     }
-    count = 0;
-    for (i = 0; i < mido->max_bridges; i++) {
-        //      mido_get_ports(&(vpcsubnet->midos[VPCBR]), &(vpcsubnet->brports), &(vpcsubnet->max_brports));
-        rc = mido_get_ports(&(mido->bridges[i]), &ports, &max_ports);
-        if (!rc && max_ports) {
-            mido->brports = realloc(mido->brports, sizeof(midoname) * (mido->max_brports + max_ports));
-            for (j = 0; j < max_ports; j++) {
-                bzero(&(mido->brports[count]), sizeof(midoname));
-                mido_copy_midoname(&(mido->brports[count]), &(ports[j]));
-                count++;
-            }
-            mido->max_brports += max_ports;
-        }
-        if (ports && max_ports > 0) {
-            mido_free_midoname_list(ports, max_ports);
-            EUCA_FREE(ports);
+
+    rc = mido_get_ports_all(mido->bridges, mido->max_bridges, &ports, &max_ports);
+    if (rc) {
+        LOGWARN("could not read the ports of some bridges\n");
+    }
+    if (ports && max_ports > 0) {
+        count = mido->max_brports;
+        mido->brports = realloc(mido->brports, sizeof(midoname) * (mido->max_brports + max_ports));
+        for (j = 0; j < max_ports; j++) {
+            bzero(&(mido->brports[count]), sizeof(midoname));
+            mido_copy_midoname(&(mido->brports[count]), &(ports[j]));
+            count++;
         }
+        mido->max_brports += max_ports;
+        mido_free_midoname_list(ports, max_ports);
+        EUCA_FREE(ports);
     }
 
     rc = mido_get_chains("euca_tenant_1", &(mido->chains), &(mido->max_chains));
@@ -3,6 +3,8 @@
 
 #include <midonet-api.h>
 
+#define MIDO_FULL_RESYNC_INTERVAL                300    //!< seconds after which the local mirror is thrown away and rebuilt from MidoNet
+
 enum { VPCSG_INGRESS, VPCSG_EGRESS, VPCSG_IAGPRIV, VPCSG_IAGPUB, VPCSG_IAGALL, VPCSG_END };
 typedef struct mido_vpc_secgroup_t {
     gni_secgroup *gniSecgroup;
@@ -63,6 +65,8 @@ typedef struct mido_config_t {
     mido_vpc_secgroup *vpcsecgroups;
     int max_vpcsecgroups;
     int router_ids[4096];
+    int populated;                     //!< set once an update went through, the mirror above then matches MidoNet
+    time_t populated_at;               //!< when the mirror was last rebuilt from MidoNet
 } mido_config;
 
 int get_next_router_id(mido_config * mido, int *nextid);
@@ -114,7 +118,7 @@ void print_mido_vpc_subnet(mido_vpc_subnet * vpcsubnet);
 void print_mido_vpc_instance(mido_vpc_instance * vpcinstance);
 void print_mido_vpc_secgroup(mido_vpc_secgroup * vpcsecgroup);
 
-int do_midonet_update(globalNetworkInfo * gni, mido_config * mido);
+int do_midonet_update(globalNetworkInfo * gni, gni_delta * delta, mido_config * mido);
 int do_midonet_teardown(mido_config * mido);
 
 int do_metaproxy_setup(mido_config * mido);
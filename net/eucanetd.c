@@ -80,9 +80,20 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <pthread.h>
 
 #include <eucalyptus.h>
 #include <misc.h>
@@ -96,6 +107,7 @@
 #include <sequence_executor.h>
 #include <ipt_handler.h>
 #include <atomic_file.h>
+#include <hashtable.h>
 
 #include "eucanetd.h"
 #include "config-eucanetd.h"
@@ -108,6 +120,29 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#ifdef EUCANETD_BENCH
+//! @{
+//! @name Defaults of the control-plane benchmark (see do_benchmark())
+#define BENCH_DEFAULT_INSTANCES                  256
+#define BENCH_DEFAULT_SECGROUPS                  32
+#define BENCH_DEFAULT_RULES                      8
+#define BENCH_DEFAULT_LOCAL                      64
+#define BENCH_DEFAULT_CHURN                      10
+#define BENCH_DEFAULT_ITERATIONS                 20
+//! @}
+
+#define BENCH_MAX_INSTANCES                      60000  //!< the private IPs come out of a single /16
+#define BENCH_INSTANCES_PER_NODE                 32 //!< how many of the non-local instances each remote node runs
+#define BENCH_DEVICE                             "eucabench0"   //!< the bridge and public interface the benchmark uses
+
+//! The interface lookups go through a stand-in sysfs in the dry-run benchmark
+#define SYS_CLASS_NET_DIR                        bench_sys_class_net
+#else /* EUCANETD_BENCH */
+#define SYS_CLASS_NET_DIR                        "/sys/class/net"
+#endif /* EUCANETD_BENCH */
+
+#define IFACE_TABLE_RCVBUF                       (1024 * 1024)  //!< room for the link notifications that pile up between two lookups
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -120,12 +155,88 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! The phases of an EDGE mode update, in the order they are deployed in, see apply_edge_update()
+typedef enum apply_phase_t {
+    APPLY_PHASE_SECGROUPS,             //!< ipsets and iptables filter rules of the security groups
+    APPLY_PHASE_PRIVATEIPS,            //!< dhcpd configuration of the local instances
+    APPLY_PHASE_PUBLICIPS,             //!< public addresses and iptables nat rules, on top of the chains and sets of the security groups
+    APPLY_PHASE_ISOLATION,             //!< ebtables rules isolating the local instances
+    APPLY_PHASES
+} apply_phase;
+
+#ifdef EUCANETD_BENCH
+//! What the time of one benchmark iteration is broken into
+typedef enum bench_stage_t {
+    BENCH_STAGE_PARSE,                 //!< gni_populate() and the rest of read_latest_network()
+    BENCH_STAGE_DIFF,                  //!< working out what changed since the last update
+    BENCH_STAGE_SECGROUPS,             //!< the whole of update_sec_groups()
+    BENCH_STAGE_PUBLICIPS,             //!< the whole of update_public_ips()
+    BENCH_STAGE_ISOLATION,             //!< the whole of update_isolation_rules()
+    BENCH_STAGE_MODEL,                 //!< what the update functions spend outside of the deploys and the commands they run
+    BENCH_STAGE_RENDER_IPT,            //!< ipt_handler_deploy() minus the iptables-restore it runs
+    BENCH_STAGE_RENDER_IPS,            //!< ips_handler_deploy() minus the ipset restore it runs
+    BENCH_STAGE_RENDER_EBT,            //!< ebt_handler_deploy() minus the ebtables commands it runs
+    BENCH_STAGE_RENDER_NFT,            //!< nft_handler_deploy() minus the nft run it makes
+    BENCH_STAGE_APPLY_IPT,             //!< iptables-restore
+    BENCH_STAGE_APPLY_IPS,             //!< ipset restore
+    BENCH_STAGE_APPLY_EBT,             //!< ebtables-restore and the atomic file fallback
+    BENCH_STAGE_APPLY_NFT,             //!< nft -f
+    BENCH_STAGE_APPLY_CMDS,            //!< everything else that is run, e.g. 'ip addr'
+    BENCH_STAGE_READBACK,              //!< iptables-save, ipset save and the ebtables listings the repopulates run, and nft listings
+    BENCH_STAGE_ITERATION,             //!< one update, from parsing to the last deploy
+    BENCH_STAGES
+} bench_stage;
+#endif /* EUCANETD_BENCH */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#ifdef EUCANETD_BENCH
+//! The per-iteration samples of one stage
+typedef struct bench_samples_t {
+    long long *usec;
+    int len;
+} bench_samples;
+
+//! A chain the dry-run stand-in keeps for iptables and ebtables, or a set it keeps for ipset
+typedef struct bench_chain_t {
+    char table[32];                    //!< empty for a set
+    char name[128];
+    char policy[256];                  //!< the rest of the chain line, or the type of a set
+    char **rules;                      //!< the rules without their '-A <chain>' prefix, or the members of a set
+    int max_rules;
+} bench_chain;
+#endif /* EUCANETD_BENCH */
+
+//! A network interface of the host, as rtnetlink last told about it
+typedef struct iface_entry_t {
+    int ifindex;
+    char name[IFNAMSIZ];
+    char mac[32];                      //!< lower case, as in /sys/class/net/<name>/address
+} iface_entry;
+
+//! The network interfaces of the host, kept up to date from rtnetlink link notifications
+typedef struct iface_table_t {
+    int fd;                            //!< the rtnetlink socket subscribed to link changes, -1 if the table is not in use
+    hashtable *byindex;                //!< interface index to iface_entry, the owner of the entries
+    hashtable *byname;                 //!< interface name to iface_entry
+    hashtable *bymac;                  //!< MAC without its first octet to iface_entry, see mac2interface()
+} iface_table;
+
+//! One phase of an EDGE mode update: a model built from globalnetworkinfo, then deployed on the system
+typedef struct apply_step_t {
+    int wanted;                        //!< set if the phase is part of this update
+    int (*build) (boolean * deploy);   //!< builds the model, alongside the builds of the other phases, NULL if the phase has none
+    int (*deploy) (void);              //!< puts the model on the system, in phase order
+    boolean do_deploy;                 //!< cleared by a build that failed too badly for its model to be deployed
+    int rc;                            //!< 0 if both the build and the deploy went well
+    long long build_usec;              //!< what the build took
+    long long deploy_usec;             //!< what the deploy took
+} apply_step;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -143,6 +254,8 @@
 //vnetConfig *vnetconfig = NULL;
 eucanetdConfig *config = NULL;
 globalNetworkInfo *globalnetworkinfo = NULL;
+globalNetworkInfo *lastglobalnetworkinfo = NULL;   //!< the network info as of the last successful update
+gni_delta globalnetworkdelta = { 0 };  //!< what changed between lastglobalnetworkinfo and globalnetworkinfo
 mido_config *mido = NULL;
 
 configEntry configKeysRestartEUCANETD[] = {
@@ -194,6 +307,8 @@ configEntry configKeysRestartEUCANETD[] = {
     ,
     {"MIDOPUBGWIP", NULL}
     ,
+    {"FIREWALL_BACKEND", "iptables"}
+    ,
     {NULL, NULL}
     ,
 };
@@ -231,18 +346,128 @@ configEntry configKeysNoRestartEUCANETD[] = {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static iface_table ifaces = { -1, NULL, NULL, NULL };
+static boolean ifaces_failed = FALSE;  //!< set once rtnetlink could not be used, the lookups go through sysfs from then on
+
+//! What the phases of the EDGE mode updates took since the last "eucanetd report", see apply_report()
+static struct {
+    int runs;
+    long long build_usec;
+    long long deploy_usec;
+} apply_stats[APPLY_PHASES] = { {0} };
+static long long apply_wall_usec = 0;  //!< wall clock time of all those updates, below the sum of the phases when the builds overlap
+static int apply_updates = 0;          //!< number of those updates
+
+static const char *apply_phase_names[APPLY_PHASES] = {
+    "sec_groups", "private_ips", "public_ips", "isolation",
+};
+
+#ifdef EUCANETD_BENCH
+static char bench_sys_class_net[EUCA_MAX_PATH] = "/sys/class/net";
+static char bench_statedir[EUCA_MAX_PATH] = "";
+static long long bench_acc[BENCH_STAGES] = { 0 };   //!< what each stage took in the current iteration
+static int bench_ran[BENCH_STAGES] = { 0 }; //!< whether each stage ran in the current iteration
+static long long bench_inner_usec = 0; //!< what the current update function spent in deploys and commands
+static bench_samples bench_samples_of[BENCH_STAGES] = { {0} };
+
+static const char *bench_stage_names[BENCH_STAGES] = {
+    "parse", "diff", "sec_groups", "public_ips", "isolation", "model", "render_ipt", "render_ips", "render_ebt", "render_nft",
+    "apply_ipt", "apply_ips", "apply_ebt", "apply_nft", "apply_cmds", "readback", "iteration",
+};
+
+//! @{
+//! @name The synthetic network view (see bench_write_network())
+static int bench_instances = BENCH_DEFAULT_INSTANCES;
+static int bench_secgroups = BENCH_DEFAULT_SECGROUPS;
+static int bench_rules = BENCH_DEFAULT_RULES;
+static int bench_local = BENCH_DEFAULT_LOCAL;
+static int bench_pool = 0;
+static int *bench_public_of = NULL;    //!< the public IP index of each instance
+static int *bench_owner_of = NULL;     //!< the instance holding each public IP, -1 when free
+//! @}
+#endif /* EUCANETD_BENCH */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void iface_table_clear(void);
+static void iface_table_key(const char *mac, char *key, int key_size);
+static void iface_table_link(struct nlmsghdr *nh);
+static int iface_table_dump(void);
+static int iface_table_sync(void);
+static char *mac2interface_sysfs(char *mac);
+
+static int build_sec_groups(boolean * deploy);
+static int deploy_sec_groups(void);
+static int build_private_ips(boolean * deploy);
+static int deploy_private_ips(void);
+static int restart_dhcpd_server(void);
+static int build_isolation_rules(boolean * deploy);
+static int deploy_isolation_rules(void);
+static int find_moved_public_ips(gni_node * myself, u32 ** outips, int *outmax);
+static void apply_edge_plan(apply_step * steps, int update_secgroups, int update_node, int update_publicips);
+static void *apply_build_thread(void *arg);
+static int apply_edge_update(apply_step * steps);
+static void apply_report(void);
+
+#ifdef EUCANETD_BENCH
+static void bench_collect(void);
+static void bench_deployed(bench_stage stage, long long started);
+static int bench_ipt_handler_deploy(ipt_handler * ipth);
+static int bench_ips_handler_deploy(ips_handler * ipsh, int dodelete);
+static int bench_ebt_handler_deploy(ebt_handler * ebth);
+static int bench_nft_handler_deploy(nft_handler * nfth, ipt_handler * ipth, ips_handler * ipsh, ebt_handler * ebth);
+static int bench_update(bench_stage stage, int (*update) (void));
+static int bench_compare(const void *a, const void *b);
+static void bench_report(FILE * out, const char *config, int failed, long xml_bytes, long long elapsed_usec);
+
+static bench_chain *bench_chain_find(bench_chain * chains, int max, const char *table, const char *name);
+static bench_chain *bench_chain_add(bench_chain ** chains, int *max, const char *table, const char *name, const char *policy);
+static void bench_chain_append(bench_chain * chain, const char *rule);
+static void bench_chain_flush(bench_chain * chain);
+static void bench_chain_del(bench_chain * chains, int *max, bench_chain * chain);
+static void bench_chains_free(bench_chain * chains, int max);
+static void bench_chains_restore(FILE * FH, bench_chain ** chains, int *max, int noflush);
+static void bench_chains_save(FILE * FH, bench_chain * chains, int max, int counters);
+static void bench_chains_list(FILE * FH, bench_chain * chains, int max, const char *table);
+static void bench_sets_restore(FILE * FH, bench_chain ** sets, int *max);
+static void bench_sets_save(FILE * FH, bench_chain * sets, int max);
+static int bench_state_load(const char *file, int sets, bench_chain ** chains, int *max);
+static int bench_state_store(const char *file, bench_chain * chains, int max, int sets);
+static char *bench_arg_after(int argc, char **argv, const char *arg);
+static int bench_has_arg(int argc, char **argv, const char *arg);
+static int bench_standin_stage(int argc, char **argv);
+static int bench_emulate(int argc, char **argv);
+static int bench_standin(int argc, char **argv);
+
+static int bench_write_network(const char *path, long *bytes);
+static void bench_churn(int churn);
+static int bench_setup_devices(int apply);
+static void bench_cleanup(void);
+static int bench_run_in_namespace(int argc, char **argv);
+static int do_benchmark(int argc, char **argv);
+#endif /* EUCANETD_BENCH */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! @{
+//! @name Benchmark hooks
+//! Break the deploys down into rendering and applying in the benchmark build and vanish from all others
+#ifdef EUCANETD_BENCH
+#define ipt_handler_deploy(_ipth)                bench_ipt_handler_deploy((_ipth))
+#define ips_handler_deploy(_ipsh, _dodelete)     bench_ips_handler_deploy((_ipsh), (_dodelete))
+#define ebt_handler_deploy(_ebth)                bench_ebt_handler_deploy((_ebth))
+#define nft_handler_deploy(_nfth, _ipth, _ipsh, _ebth) bench_nft_handler_deploy((_nfth), (_ipth), (_ipsh), (_ebth))
+#endif /* EUCANETD_BENCH */
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -276,7 +501,14 @@ int main(int argc, char **argv)
     int epoch_checks = 0;
     int update_globalnet_failed = 0;
     int update_globalnet = 0;
+    int update_globalnet_full = 0;
+    int update_secgroups = 0;
+    int update_node = 0;
+    gni_node *myself = NULL;
+    globalNetworkInfo *swapgni = NULL;
+    apply_step steps[APPLY_PHASES] = { {0} };
     time_t epoch_timer = 0;
+    time_t loop_started = 0;
 
     /*
     {
@@ -294,6 +526,15 @@ int main(int argc, char **argv)
     }
     */
 
+#ifdef EUCANETD_BENCH
+    // the benchmark stands in for the commands the handlers run by being their command prefix
+    if ((argc > 2) && !strcmp(argv[1], "-X")) {
+        exit(bench_standin(argc, argv));
+    }
+    eucanetdInit();
+    exit(do_benchmark(argc, argv));
+#endif /* EUCANETD_BENCH */
+
     // initialize
     eucanetdInit();
 
@@ -364,10 +605,15 @@ int main(int argc, char **argv)
         }
         exit(0);
     }
+    // changes get pushed to us as they happen, the polling below remains a fallback
+    if (init_network_notify()) {
+        LOGWARN("cannot listen for network info notifications, falling back to polling every %d seconds\n", config->polling_frequency);
+    }
     // got all config, enter main loop
     //    while(counter<3) {
     while (1) {
         update_globalnet = 0;
+        update_globalnet_full = 0;
 
         counter++;
 
@@ -379,15 +625,24 @@ int main(int argc, char **argv)
         // first time we run, force an update
         if (firstrun) {
             update_globalnet = 1;
+            update_globalnet_full = 1;
             firstrun = 0;
         }
         // if the last update operations failed, regardless of new info, force an update
         if (update_globalnet_failed) {
             LOGDEBUG("last update of network state failed, forcing a retry: update_globalnet_failed=%d\n", update_globalnet_failed);
             update_globalnet = 1;
+            update_globalnet_full = 1;
         }
         update_globalnet_failed = 0;
 
+        // the local mirror of midonet is kept between updates, and rebuilt from scratch every so often as a safety net
+        if (!strcmp(config->vnetMode, "VPCMIDO") && mido && mido->populated && ((time(NULL) - mido->populated_at) >= MIDO_FULL_RESYNC_INTERVAL)) {
+            LOGDEBUG("local midonet mirror is %d seconds old, forcing a full resync\n", (int)(time(NULL) - mido->populated_at));
+            update_globalnet = 1;
+            update_globalnet_full = 1;
+        }
+
         // whether or not updates have occurred due to remote content being updated, read local networking info
         rc = read_latest_network();
         if (rc) {
@@ -402,60 +657,107 @@ int main(int argc, char **argv)
         if (!strcmp(config->vnetMode, "VPCMIDO")) {
             LOGTRACE("IN VPCMIDO MODE\n");
             if (update_globalnet) {
-                free_mido_config(mido);
-                bzero(mido, sizeof(mido_config));
-                rc = initialize_mido(mido, config->eucahome, config->midosetupcore, config->midoeucanetdhost, config->midogwhost, config->midogwip, config->midogwiface, config->midopubnw,
-                                     config->midopubgwip, "169.254.0.0", "17");
-                if (rc) {
-                    LOGERROR("could not initialize mido config\n");
-                    update_globalnet_failed = 1;
-                } else {
-                    rc = do_midonet_update(globalnetworkinfo, mido);
+                gni_delta_clear(&globalnetworkdelta);
+                if (update_globalnet_full || !mido->populated || gni_diff(lastglobalnetworkinfo, globalnetworkinfo, &globalnetworkdelta)) {
+                    globalnetworkdelta.full = 1;
+                }
+
+                if (gni_delta_is_empty(&globalnetworkdelta)) {
+                    LOGINFO("new Eucalyptus/Midonet networking state sync: no changes\n");
+                } else if (!globalnetworkdelta.full && !globalnetworkdelta.config_changed) {
+                    rc = do_midonet_update(globalnetworkinfo, &globalnetworkdelta, mido);
                     if (rc) {
                         LOGERROR("could not update midonet: check log for details\n");
                         update_globalnet_failed = 1;
                     } else {
-                        LOGINFO("new Eucalyptus/Midonet networking state sync: updated successfully\n");
+                        LOGINFO("new Eucalyptus/Midonet networking state sync: changes applied successfully\n");
+                    }
+                } else {
+                    free_mido_config(mido);
+                    bzero(mido, sizeof(mido_config));
+                    rc = initialize_mido(mido, config->eucahome, config->midosetupcore, config->midoeucanetdhost, config->midogwhost, config->midogwip, config->midogwiface,
+                                         config->midopubnw, config->midopubgwip, "169.254.0.0", "17");
+                    if (rc) {
+                        LOGERROR("could not initialize mido config\n");
+                        update_globalnet_failed = 1;
+                    } else {
+                        rc = do_midonet_update(globalnetworkinfo, NULL, mido);
+                        if (rc) {
+                            LOGERROR("could not update midonet: check log for details\n");
+                            update_globalnet_failed = 1;
+                        } else {
+                            LOGINFO("new Eucalyptus/Midonet networking state sync: updated successfully\n");
+                        }
                     }
                 }
+
+                // what has been applied is what the next changes get compared to
+                if (!update_globalnet_failed) {
+                    swapgni = lastglobalnetworkinfo;
+                    lastglobalnetworkinfo = globalnetworkinfo;
+                    globalnetworkinfo = swapgni;
+                }
             }
         } else if (!strcmp(config->vnetMode, "EDGE")) {
-            // if information on sec. group rules/membership has changed, apply
+            // work out what changed since the last successful update, so that only what it affects gets redone
+            update_secgroups = update_node = 0;
             if (update_globalnet) {
+                gni_delta_clear(&globalnetworkdelta);
+                if (update_globalnet_full || gni_diff(lastglobalnetworkinfo, globalnetworkinfo, &globalnetworkdelta)) {
+                    globalnetworkdelta.full = 1;
+                }
+
+                if (gni_delta_is_empty(&globalnetworkdelta)) {
+                    LOGINFO("new networking state: no changes that apply to this system\n");
+                } else {
+                    // only a change to the public IP pool leaves the sec. groups alone
+                    update_secgroups = (globalnetworkdelta.full || globalnetworkdelta.config_changed || globalnetworkdelta.max_added_instances
+                                        || globalnetworkdelta.max_removed_instances || globalnetworkdelta.max_modified_instances || globalnetworkdelta.max_added_secgroups
+                                        || globalnetworkdelta.max_removed_secgroups || globalnetworkdelta.max_modified_secgroups);
+                    myself = NULL;
+                    gni_find_self_node(globalnetworkinfo, &myself);
+                    update_node = (!myself || gni_delta_touches_node(&globalnetworkdelta, lastglobalnetworkinfo, globalnetworkinfo, myself->name));
+                }
+            }
+            // the phases that apply build their models side by side, then deploy them one after the other
+            apply_edge_plan(steps, update_secgroups, update_node, (update_secgroups || update_node || (update_globalnet && globalnetworkdelta.public_ips_changed)));
+            if (update_secgroups) {
                 LOGINFO("new networking state (VM security groups): updating system\n");
-                // install iptables FW rules, using IPsets for sec. group
-                rc = update_sec_groups();
-                if (rc) {
+            }
+            if (steps[APPLY_PHASE_PUBLICIPS].wanted) {
+                LOGINFO("new networking state (VM public/private network addresses, VM network isolation): updating system\n");
+                apply_edge_update(steps);
+            }
+            // if information on sec. group rules/membership has changed, it was applied (install iptables FW rules, using IPsets for sec. group)
+            if (steps[APPLY_PHASE_SECGROUPS].wanted) {
+                if (steps[APPLY_PHASE_SECGROUPS].rc) {
                     LOGERROR("could not complete update of security groups: check above log errors for details\n");
                     update_globalnet_failed = 1;
                 } else {
                     LOGINFO("new networking state (VM security groups): updated successfully\n");
                 }
             }
-            // if information about local VM network config has changed, apply
-            if (update_globalnet) {
-                LOGINFO("new networking state (VM public/private network addresses, VM network isolation): updating system\n");
-                // update list of private IPs, handle DHCP daemon re-configure and restart
-                rc = update_private_ips();
-                if (rc) {
+            // update list of private IPs, handle DHCP daemon re-configure and restart
+            if (steps[APPLY_PHASE_PRIVATEIPS].wanted) {
+                if (steps[APPLY_PHASE_PRIVATEIPS].rc) {
                     LOGERROR("could not complete update of private IPs: check above log errors for details\n");
                     update_globalnet_failed = 1;
                 } else {
                     LOGINFO("new networking state (VM private network addresses): updated successfully\n");
                 }
-
-                // update public IP assignment and NAT table entries
-                rc = update_public_ips();
-                if (rc) {
+            }
+            // update public IP assignment and NAT table entries (the sec. group update empties the counter chains these refill)
+            if (steps[APPLY_PHASE_PUBLICIPS].wanted) {
+                if (steps[APPLY_PHASE_PUBLICIPS].rc) {
                     LOGERROR("could not complete update of public IPs: check above log errors for details\n");
                     update_globalnet_failed = 1;
                 } else {
                     LOGINFO("new networking state (VM public network addresses): updated successfully\n");
                 }
-
-                // install ebtables rules for isolation
-                rc = update_isolation_rules();
-                if (rc) {
+            }
+            // install ebtables rules for isolation
+            if (steps[APPLY_PHASE_ISOLATION].wanted) {
+                if (steps[APPLY_PHASE_ISOLATION].rc) {
                     if (epoch_failed_updates >= 60) {
                         LOGERROR("could not complete update of VM network isolation rules after 60 retries: check above log errors for details\n");
                     } else {
@@ -466,6 +768,12 @@ int main(int argc, char **argv)
                     LOGINFO("new networking state (VM network isolation): updated successfully\n");
                 }
             }
+            // what has been applied is what the next changes get compared to
+            if (update_globalnet && !update_globalnet_failed) {
+                swapgni = lastglobalnetworkinfo;
+                lastglobalnetworkinfo = globalnetworkinfo;
+                globalnetworkinfo = swapgni;
+            }
         }
 
         if (update_globalnet) {
@@ -484,19 +792,21 @@ int main(int argc, char **argv)
         if (epoch_timer >= 300) {
             LOGINFO("eucanetd report: tot_checks=%d tot_update_attempts=%d success_update_attempts=%d fail_update_attempts=%d duty_cycle_minutes=%f\n", epoch_checks,
                     epoch_updates + epoch_failed_updates, epoch_updates, epoch_failed_updates, (float)epoch_timer / 60.0);
+            apply_report();
             epoch_checks = epoch_updates = epoch_failed_updates = epoch_timer = 0;
         }
         // do it all over again...
 
+        loop_started = time(NULL);
         if (update_globalnet_failed) {
             LOGDEBUG("main loop complete: failures detected sleeping %d seconds before next poll\n", 1);
             sleep(1);
         } else {
-            LOGDEBUG("main loop complete: sleeping %d seconds before next poll\n", config->polling_frequency);
-            sleep(config->polling_frequency);
+            LOGDEBUG("main loop complete: waiting up to %d seconds for a notification before next poll\n", config->polling_frequency);
+            wait_for_network_notify(config->polling_frequency);
         }
 
-        epoch_timer += config->polling_frequency;
+        epoch_timer += (time(NULL) - loop_started);
     }
 
     //    gni_free(globalnetworkinfo);
@@ -613,6 +923,27 @@ int daemonize(void)
 //! @note
 //!
 int update_isolation_rules(void)
+{
+    int ret = 0;
+    boolean deploy = TRUE;
+
+    ret = build_isolation_rules(&deploy);
+    if (deploy) {
+        ret |= deploy_isolation_rules();
+    }
+    return (ret);
+}
+
+//!
+//! Builds the ebtables rules isolating the local instances from each other. Only
+//! config->ebt and the interface table are touched, so this may run alongside the
+//! builds of the other phases.
+//!
+//! @param[out] deploy cleared if the rules should not be deployed
+//!
+//! @return 0 on success or 1 if any of the instances could not be handled
+//!
+static int build_isolation_rules(boolean * deploy)
 {
     int i = 0;
     int rc = 0;
@@ -633,10 +964,14 @@ int update_isolation_rules(void)
     rc = gni_find_self_cluster(globalnetworkinfo, &mycluster);
     if (rc) {
         LOGERROR("cannot find cluster to which local node belongs, in global network view: check network config settings\n");
+        *deploy = FALSE;
         return (1);
     }
 
-    rc = ebt_handler_repopulate(config->ebt);
+    // with nftables, the model is what is on the system
+    if (!config->nftables) {
+        rc = ebt_handler_repopulate(config->ebt);
+    }
 
     rc = ebt_table_add_chain(config->ebt, "filter", "EUCA_EBT_FWD", "ACCEPT", "");
     rc = ebt_chain_add_rule(config->ebt, "filter", "FORWARD", "-j EUCA_EBT_FWD");
@@ -792,8 +1127,25 @@ int update_isolation_rules(void)
 
     EUCA_FREE(instances);
 
+    return (ret);
+}
+
+//!
+//! Deploys the ebtables rules build_isolation_rules() put together
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int deploy_isolation_rules(void)
+{
+    int rc = 0;
+    int ret = 0;
+
     rc = ebt_handler_print(config->ebt);
-    rc = ebt_handler_deploy(config->ebt);
+    if (config->nftables) {
+        rc = nft_handler_deploy(config->nft, config->ipt, config->ips, config->ebt);
+    } else {
+        rc = ebt_handler_deploy(config->ebt);
+    }
     if (rc) {
         LOGERROR("could not install ebtables rules: check above log errors for details\n");
         ret = 1;
@@ -826,6 +1178,7 @@ int eucanetdInit(void)
     }
     bzero(config, sizeof(eucanetdConfig));
     config->polling_frequency = 5;
+    config->notify_fd = -1;
     config->init = 1;
 
     if (!globalnetworkinfo) {
@@ -836,6 +1189,14 @@ int eucanetdInit(void)
         }
     }
 
+    if (!lastglobalnetworkinfo) {
+        lastglobalnetworkinfo = gni_init();
+        if (!lastglobalnetworkinfo) {
+            LOGFATAL("out of memory\n");
+            exit(1);
+        }
+    }
+
     if (!mido) {
         mido = calloc(1, sizeof(mido_config));
     }
@@ -857,6 +1218,27 @@ int eucanetdInit(void)
 //! @note
 //!
 int update_sec_groups(void)
+{
+    int ret = 0;
+    boolean deploy = TRUE;
+
+    ret = build_sec_groups(&deploy);
+    if (deploy) {
+        ret |= deploy_sec_groups();
+    }
+    return (ret);
+}
+
+//!
+//! Builds the ipsets and iptables filter chains of the security groups. Only
+//! config->ips and the filter table of config->ipt are touched, so this may run
+//! alongside the builds of the other phases.
+//!
+//! @param[out] deploy cleared if the current rules could not be read, and the new ones should not be deployed
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int build_sec_groups(boolean * deploy)
 {
     int i = 0;
     int j = 0;
@@ -874,18 +1256,21 @@ int update_sec_groups(void)
     rc = gni_find_self_cluster(globalnetworkinfo, &mycluster);
     if (rc) {
         LOGERROR("cannot find cluster to which local node belongs, in global network view: check network config settings\n");
+        *deploy = FALSE;
         return (1);
     }
-    // pull in latest IPT state
-    rc = ipt_handler_repopulate(config->ipt);
+    // pull in latest IPT state (with nftables, the model is what is on the system)
+    rc = ((config->nftables) ? 0 : ipt_handler_repopulate(config->ipt));
     if (rc) {
         LOGERROR("cannot read current IPT rules: check above log errors for details\n");
+        *deploy = FALSE;
         return (1);
     }
     // pull in latest IPS state
-    rc = ips_handler_repopulate(config->ips);
+    rc = ((config->nftables) ? 0 : ips_handler_repopulate(config->ips));
     if (rc) {
         LOGERROR("cannot read current IPS sets: check above log errors for details\n");
+        *deploy = FALSE;
         return (1);
     }
     // make sure euca chains are in place
@@ -1022,7 +1407,32 @@ int update_sec_groups(void)
     snprintf(rule, 1024, "-A EUCA_FILTER_FWD -m set --match-set EUCA_ALLPRIVATE dst -j DROP");
     ipt_chain_add_rule(config->ipt, "filter", "EUCA_FILTER_FWD", rule);
 
-    if (1 || !ret) {
+    return (ret);
+}
+
+//!
+//! Deploys the ipsets and iptables rules build_sec_groups() put together: the new
+//! sets go in first, then the rules and last the no longer referenced sets go
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int deploy_sec_groups(void)
+{
+    int rc = 0;
+    int ret = 0;
+
+    if (config->nftables) {
+        // sets and rules go in together, so no set is ever missing a rule that references it
+        ips_handler_print(config->ips);
+        ipt_handler_print(config->ipt);
+        rc = nft_handler_deploy(config->nft, config->ipt, config->ips, config->ebt);
+        if (rc) {
+            LOGERROR("could not apply new rules: check above log errors for details\n");
+            ret = 1;
+        }
+    }
+
+    if (!config->nftables) {
         ips_handler_print(config->ips);
         rc = ips_handler_deploy(config->ips, 0);
         if (rc) {
@@ -1031,7 +1441,7 @@ int update_sec_groups(void)
         }
     }
 
-    if (1 || !ret) {
+    if (!config->nftables) {
         ipt_handler_print(config->ipt);
         rc = ipt_handler_deploy(config->ipt);
         if (rc) {
@@ -1040,7 +1450,7 @@ int update_sec_groups(void)
         }
     }
 
-    if (1 || !ret) {
+    if (!config->nftables) {
         ips_handler_print(config->ips);
         rc = ips_handler_deploy(config->ips, 1);
         if (rc) {
@@ -1073,11 +1483,17 @@ int update_public_ips(void)
     gni_cluster *mycluster = NULL;
     gni_node *myself = NULL;
     gni_instance *instances = NULL;
+    gni_instance *lastinstance = NULL;
     int max_instances = 0;
+    int full = 0;
+    u32 *candidate_ips = NULL, *released_ips = NULL, *moved_ips = NULL;
+    int max_candidate_ips = 0, max_moved_ips = 0;
     u32 nw, nm;
 
     LOGDEBUG("updating public IP to private IP mappings\n");
 
+    full = (globalnetworkdelta.full || globalnetworkdelta.config_changed);
+
     rc = gni_find_self_cluster(globalnetworkinfo, &mycluster);
     if (rc) {
         LOGERROR("cannot locate cluster to which local node belongs, in global network view: check network config settings\n");
@@ -1091,7 +1507,7 @@ int update_public_ips(void)
     slashnet = 32 - ((int)(log2((double)((0xFFFFFFFF - nm) + 1))));
 
     // install EL IP addrs and NAT rules
-    rc = ipt_handler_repopulate(config->ipt);
+    rc = ((config->nftables) ? 0 : ipt_handler_repopulate(config->ipt));
     ipt_table_add_chain(config->ipt, "nat", "EUCA_NAT_PRE_PREUSERHOOK", "-", "[0:0]");
     ipt_table_add_chain(config->ipt, "nat", "EUCA_NAT_PRE", "-", "[0:0]");
     ipt_table_add_chain(config->ipt, "nat", "EUCA_NAT_PRE_POSTUSERHOOK", "-", "[0:0]");
@@ -1113,13 +1529,13 @@ int update_public_ips(void)
     ipt_chain_add_rule(config->ipt, "nat", "OUTPUT", "-A OUTPUT -j EUCA_NAT_OUT_POSTUSERHOOK");
 
     //  rc = ipt_handler_print(config->ipt);
-    rc = ipt_handler_deploy(config->ipt);
+    rc = ((config->nftables) ? nft_handler_deploy(config->nft, config->ipt, config->ips, config->ebt) : ipt_handler_deploy(config->ipt));
     if (rc) {
         LOGERROR("could not add euca net chains: check above log errors for details\n");
         ret = 1;
     }
 
-    rc = ipt_handler_repopulate(config->ipt);
+    rc = ((config->nftables) ? 0 : ipt_handler_repopulate(config->ipt));
 
     ipt_chain_flush(config->ipt, "nat", "EUCA_NAT_PRE");
     ipt_chain_flush(config->ipt, "nat", "EUCA_NAT_POST");
@@ -1153,28 +1569,25 @@ int update_public_ips(void)
         rc = gni_node_get_instances(globalnetworkinfo, myself, NULL, 0, NULL, 0, &instances, &max_instances);
     }
 
+    // the addresses of all instances go up at once, each followed by its arping
+    rc = se_init(&cmds, config->cmdprefix, 2, 1);
+    rc = se_set_parallel(&cmds, MAX_SE_PARALLEL);
+
     for (i = 0; i < max_instances; i++) {
         strptra = hex2dot(instances[i].publicIp);
         strptrb = hex2dot(instances[i].privateIp);
         LOGTRACE("instance pub/priv: %s: %s/%s\n", instances[i].name, strptra, strptrb);
         if ((instances[i].publicIp && instances[i].privateIp) && (instances[i].publicIp != instances[i].privateIp)) {
 
-            // run some commands
-            rc = se_init(&cmds, config->cmdprefix, 2, 1);
+            // the address is already up for the instances that did not change since the last update
+            if ((full || gni_delta_has_instance(&globalnetworkdelta, instances[i].name)) && (cmds.max_commands < (MAX_SE_COMMANDS - 1))) {
+                snprintf(cmd, EUCA_MAX_PATH, "ip addr add %s/%d dev %s >/dev/null 2>&1", strptra, 32, config->pubInterface);
+                rc = se_add(&cmds, cmd, NULL, ignore_exit2);
 
-            snprintf(cmd, EUCA_MAX_PATH, "ip addr add %s/%d dev %s >/dev/null 2>&1", strptra, 32, config->pubInterface);
-            rc = se_add(&cmds, cmd, NULL, ignore_exit2);
-            
-            snprintf(cmd, EUCA_MAX_PATH, "arping -c 5 -w 1 -U -I %s %s >/dev/null 2>&1 &", config->pubInterface, strptra);
-            rc = se_add(&cmds, cmd, NULL, ignore_exit);
-            
-            se_print(&cmds);
-            rc = se_execute(&cmds);
-            if (rc) {
-                LOGERROR("could not execute command sequence (check above log errors for details): adding ips, sending arpings\n");
-                ret = 1;
+                snprintf(cmd, EUCA_MAX_PATH, "arping -c 5 -w 1 -U -I %s %s >/dev/null 2>&1 &", config->pubInterface, strptra);
+                rc = se_add(&cmds, cmd, NULL, ignore_exit);
+                rc = se_depend(&cmds, (cmds.max_commands - 1), (cmds.max_commands - 2));
             }
-            se_free(&cmds);
 
             snprintf(rule, 1024, "-A EUCA_NAT_PRE -d %s/32 -j DNAT --to-destination %s", strptra, strptrb);
             rc = ipt_chain_add_rule(config->ipt, "nat", "EUCA_NAT_PRE", rule);
@@ -1199,6 +1612,16 @@ int update_public_ips(void)
         EUCA_FREE(strptrb);
     }
 
+    if (cmds.max_commands > 0) {
+        se_print(&cmds);
+        rc = se_execute(&cmds);
+        if (rc) {
+            LOGERROR("could not execute command sequence (check above log errors for details): adding ips, sending arpings\n");
+            ret = 1;
+        }
+    }
+    se_free(&cmds);
+
     // lastly, install metadata redirect rule
     if (config->metadata_ip) {
         strptra = hex2dot(config->clcMetadataIP);
@@ -1210,51 +1633,136 @@ int update_public_ips(void)
     EUCA_FREE(strptra);
 
     //  rc = ipt_handler_print(config->ipt);
-    rc = ipt_handler_deploy(config->ipt);
+    rc = ((config->nftables) ? nft_handler_deploy(config->nft, config->ipt, config->ips, config->ebt) : ipt_handler_deploy(config->ipt));
     if (rc) {
         LOGERROR("could not apply new ipt handler rules: check above log errors for details\n");
         ret = 1;
     }
     // if all has gone well, now clear any public IPs that have not been mapped to private IPs
     if (!ret) {
-        
-        for (i = 0; i < globalnetworkinfo->max_public_ips; i++) {
+
+        // unless the pool changed, only the IPs held by the local instances that changed can have been released
+        if (full || globalnetworkdelta.public_ips_changed || !myself) {
+            candidate_ips = globalnetworkinfo->public_ips;
+            max_candidate_ips = globalnetworkinfo->max_public_ips;
+        } else {
+            released_ips = EUCA_ZALLOC(globalnetworkdelta.max_removed_instances + globalnetworkdelta.max_modified_instances + 1, sizeof(u32));
+            for (i = 0; i < globalnetworkdelta.max_removed_instances; i++) {
+                lastinstance = gni_find_instance(lastglobalnetworkinfo, globalnetworkdelta.removed_instances[i].name);
+                if (lastinstance && lastinstance->publicIp && !strcmp(lastinstance->node, myself->name)) {
+                    released_ips[max_candidate_ips++] = lastinstance->publicIp;
+                }
+            }
+            for (i = 0; i < globalnetworkdelta.max_modified_instances; i++) {
+                lastinstance = gni_find_instance(lastglobalnetworkinfo, globalnetworkdelta.modified_instances[i].name);
+                if (lastinstance && lastinstance->publicIp && !strcmp(lastinstance->node, myself->name)) {
+                    released_ips[max_candidate_ips++] = lastinstance->publicIp;
+                }
+            }
+            candidate_ips = released_ips;
+        }
+
+        // the addresses are independent of each other, so they go away at once
+        se_init(&cmds, config->cmdprefix, 2, 1);
+        se_set_parallel(&cmds, MAX_SE_PARALLEL);
+
+        for (i = 0; (i < max_candidate_ips) && (cmds.max_commands < MAX_SE_COMMANDS); i++) {
             int found = 0;
             
             if (max_instances > 0) {
                 // only clear IPs that are not assigned to instances running on this node
                 for (j = 0; j < max_instances && !found; j++) {
-                    if (instances[j].publicIp == globalnetworkinfo->public_ips[i]) {
+                    if (instances[j].publicIp == candidate_ips[i]) {
                         found = 1;
                     }
                 }
             }
             
             if (!found) {
-                se_init(&cmds, config->cmdprefix, 2, 1);
-                
-                strptra = hex2dot(globalnetworkinfo->public_ips[i]);
+                strptra = hex2dot(candidate_ips[i]);
                 snprintf(cmd, EUCA_MAX_PATH, "ip addr del %s/%d dev %s >/dev/null 2>&1", strptra, 32, config->pubInterface);
                 EUCA_FREE(strptra);
                 
                 rc = se_add(&cmds, cmd, NULL, ignore_exit2);
-                se_print(&cmds);
-                rc = se_execute(&cmds);
-                if (rc) {
-                    LOGERROR("could not execute command sequence (check above log errors for details): revoking no longer in use ips\n");
-                    ret = 1;
-                }
-                se_free(&cmds);
-                
                 }
         }
+
+        if (cmds.max_commands > 0) {
+            se_print(&cmds);
+            rc = se_execute(&cmds);
+            if (rc) {
+                LOGERROR("could not execute command sequence (check above log errors for details): revoking no longer in use ips\n");
+                ret = 1;
+            }
+        }
+        se_free(&cmds);
+
+        // the flows of the addresses that moved go now that the new NAT rules are in, the other flows of the node stay
+        if (!full && myself && !find_moved_public_ips(myself, &moved_ips, &max_moved_ips) && (max_moved_ips > 0)) {
+            vnetConntrackDelete(config->eucahome, moved_ips, max_moved_ips);
+        }
     }
 
+    EUCA_FREE(moved_ips);
+    EUCA_FREE(released_ips);
     EUCA_FREE(instances);
 
     return (ret);
 }
 
+//!
+//! Lists the public IPs whose NAT rules on this node the last changes moved: those of the
+//! local instances that came or went, and the old and new ones of the local instances whose
+//! public IP changed. The instances whose public IP stayed the same are left out, so that
+//! their flows are not disturbed.
+//!
+//! @param[in]  myself the local node
+//! @param[out] outips the addresses, to be freed by the caller
+//! @param[out] outmax number of addresses
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int find_moved_public_ips(gni_node * myself, u32 ** outips, int *outmax)
+{
+    int i = 0;
+    gni_instance *cur = NULL;
+    gni_instance *last = NULL;
+
+    *outmax = 0;
+    if ((*outips = EUCA_ZALLOC((globalnetworkdelta.max_added_instances + globalnetworkdelta.max_removed_instances + 2 * globalnetworkdelta.max_modified_instances + 1),
+                               sizeof(u32))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (1);
+    }
+
+    for (i = 0; i < globalnetworkdelta.max_added_instances; i++) {
+        cur = gni_find_instance(globalnetworkinfo, globalnetworkdelta.added_instances[i].name);
+        if (cur && cur->publicIp && !strcmp(cur->node, myself->name)) {
+            (*outips)[(*outmax)++] = cur->publicIp;
+        }
+    }
+    for (i = 0; i < globalnetworkdelta.max_removed_instances; i++) {
+        last = gni_find_instance(lastglobalnetworkinfo, globalnetworkdelta.removed_instances[i].name);
+        if (last && last->publicIp && !strcmp(last->node, myself->name)) {
+            (*outips)[(*outmax)++] = last->publicIp;
+        }
+    }
+    for (i = 0; i < globalnetworkdelta.max_modified_instances; i++) {
+        last = gni_find_instance(lastglobalnetworkinfo, globalnetworkdelta.modified_instances[i].name);
+        cur = gni_find_instance(globalnetworkinfo, globalnetworkdelta.modified_instances[i].name);
+        if (last && cur && (last->publicIp == cur->publicIp) && (last->privateIp == cur->privateIp) && !strcmp(last->node, cur->node)) {
+            continue;
+        }
+        if (last && last->publicIp && !strcmp(last->node, myself->name)) {
+            (*outips)[(*outmax)++] = last->publicIp;
+        }
+        if (cur && cur->publicIp && !strcmp(cur->node, myself->name) && (!last || (last->publicIp != cur->publicIp))) {
+            (*outips)[(*outmax)++] = cur->publicIp;
+        }
+    }
+    return (0);
+}
+
 //!
 //! Function description.
 //!
@@ -1283,7 +1791,201 @@ int update_private_ips(void)
     return (ret);
 }
 
+//!
+//! Works out the phases an EDGE mode update goes through
+//!
+//! @param[out] steps the phases, indexed by APPLY_PHASE_*
+//! @param[in]  update_secgroups set if the security groups changed
+//! @param[in]  update_node set if a change touches the instances of this node
+//! @param[in]  update_publicips set if the public addresses need another look, which every update of the security groups needs too
+//!
+static void apply_edge_plan(apply_step * steps, int update_secgroups, int update_node, int update_publicips)
+{
+    bzero(steps, APPLY_PHASES * sizeof(apply_step));
+
+    steps[APPLY_PHASE_SECGROUPS].wanted = update_secgroups;
+    steps[APPLY_PHASE_SECGROUPS].build = build_sec_groups;
+    steps[APPLY_PHASE_SECGROUPS].deploy = deploy_sec_groups;
+
+    steps[APPLY_PHASE_PRIVATEIPS].wanted = update_node;
+    steps[APPLY_PHASE_PRIVATEIPS].build = build_private_ips;
+    steps[APPLY_PHASE_PRIVATEIPS].deploy = deploy_private_ips;
+
+    // the NAT rules share config->ipt with the security groups and go on top of what those deployed, there is nothing to build ahead
+    steps[APPLY_PHASE_PUBLICIPS].wanted = update_publicips;
+    steps[APPLY_PHASE_PUBLICIPS].build = NULL;
+    steps[APPLY_PHASE_PUBLICIPS].deploy = update_public_ips;
+
+    steps[APPLY_PHASE_ISOLATION].wanted = update_node;
+    steps[APPLY_PHASE_ISOLATION].build = build_isolation_rules;
+    steps[APPLY_PHASE_ISOLATION].deploy = deploy_isolation_rules;
+}
+
+//!
+//! Runs the build of one phase, in a thread of its own
+//!
+//! @param[in] arg the apply_step of the phase
+//!
+//! @return NULL
+//!
+static void *apply_build_thread(void *arg)
+{
+    apply_step *step = ((apply_step *) arg);
+    long long started = mono_time_usec();
+
+    step->rc = step->build(&(step->do_deploy));
+    step->build_usec = (mono_time_usec() - started);
+    return (NULL);
+}
+
+//!
+//! Applies an EDGE mode update. The models of the phases are disjoint (the filter
+//! table and the ipsets, the dhcpd configuration file, the ebtables rules), so they
+//! are all built at once from globalnetworkinfo, each in a thread of its own. Once
+//! every model is in, the phases are deployed one at a time in APPLY_PHASE_* order,
+//! which has the chains and sets of the security groups in place before the NAT
+//! rules that refer to them. A phase whose build failed too badly is not deployed.
+//!
+//! @param[in,out] steps the phases, as set up by apply_edge_plan(), get the outcome and timings of each
+//!
+//! @return 0 on success or 1 if any of the phases failed
+//!
+static int apply_edge_update(apply_step * steps)
+{
+    int i = 0;
+    int ret = 0;
+    int builds = 0;
+    long long started = mono_time_usec();
+    long long deploy_started = 0;
+    pthread_t threads[APPLY_PHASES];
+    boolean threaded[APPLY_PHASES] = { FALSE };
+
+    for (i = 0; i < APPLY_PHASES; i++) {
+        steps[i].rc = 0;
+        steps[i].do_deploy = TRUE;
+        steps[i].build_usec = steps[i].deploy_usec = 0;
+        if (steps[i].wanted && steps[i].build)
+            builds++;
+    }
+
+    for (i = 0; i < APPLY_PHASES; i++) {
+        if (!steps[i].wanted || !steps[i].build)
+            continue;
+
+        // a lone build, or one no thread could be started for, runs right here
+        if ((builds > 1) && !pthread_create(&(threads[i]), NULL, apply_build_thread, &(steps[i]))) {
+            threaded[i] = TRUE;
+        } else {
+            apply_build_thread(&(steps[i]));
+        }
+    }
+
+    for (i = 0; i < APPLY_PHASES; i++) {
+        if (threaded[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < APPLY_PHASES; i++) {
+        if (!steps[i].wanted)
+            continue;
+
+        if (steps[i].do_deploy) {
+            deploy_started = mono_time_usec();
+            steps[i].rc |= steps[i].deploy();
+            steps[i].deploy_usec = (mono_time_usec() - deploy_started);
+        }
+        if (steps[i].rc)
+            ret = 1;
+
+        apply_stats[i].runs++;
+        apply_stats[i].build_usec += steps[i].build_usec;
+        apply_stats[i].deploy_usec += steps[i].deploy_usec;
+        LOGDEBUG("%s: built in %lld ms, deployed in %lld ms%s\n", apply_phase_names[i], (steps[i].build_usec / 1000), (steps[i].deploy_usec / 1000),
+                 ((steps[i].rc) ? " (failed)" : ""));
+    }
+
+    apply_updates++;
+    apply_wall_usec += (mono_time_usec() - started);
+    return (ret);
+}
+
+//!
+//! Logs the mean build and deploy times of the phases of the updates since the
+//! last "eucanetd report", along with the mean time of a whole update, and starts over
+//!
+static void apply_report(void)
+{
+    int i = 0;
+    int len = 0;
+    char phases[512] = "";
+
+    if (apply_updates == 0)
+        return;
+
+    for (i = 0; (i < APPLY_PHASES) && (len < sizeof(phases)); i++) {
+        if (apply_stats[i].runs == 0)
+            continue;
+        len += snprintf(phases + len, sizeof(phases) - len, " %s_ms=%.1f/%.1f", apply_phase_names[i], ((double)apply_stats[i].build_usec / 1000.0 / apply_stats[i].runs),
+                        ((double)apply_stats[i].deploy_usec / 1000.0 / apply_stats[i].runs));
+    }
+
+    LOGINFO("eucanetd report: updates=%d mean_update_ms=%.1f (build/deploy per phase:%s)\n", apply_updates, ((double)apply_wall_usec / 1000.0 / apply_updates), phases);
+
+    bzero(apply_stats, sizeof(apply_stats));
+    apply_wall_usec = 0;
+    apply_updates = 0;
+}
+
 int kick_dhcpd_server()
+{
+    if (generate_dhcpd_config()) {
+        LOGERROR("unable to generate new dhcp configuration file: check above log errors for details\n");
+        return (1);
+    }
+    return (restart_dhcpd_server());
+}
+
+//!
+//! Builds the dhcpd configuration of the local instances. Only the configuration
+//! file is written, so this may run alongside the builds of the other phases.
+//!
+//! @param[out] deploy cleared if no configuration could be written, and dhcpd should be left alone
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int build_private_ips(boolean * deploy)
+{
+    LOGDEBUG("updating private IP and DHCPD handling\n");
+
+    if (generate_dhcpd_config()) {
+        LOGERROR("unable to generate new dhcp configuration file: check above log errors for details\n");
+        *deploy = FALSE;
+        return (1);
+    }
+    return (0);
+}
+
+//!
+//! Has dhcpd take the configuration build_private_ips() wrote
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int deploy_private_ips(void)
+{
+    if (restart_dhcpd_server()) {
+        LOGERROR("unable to (re)configure local dhcpd server: check above log errors for details\n");
+        return (1);
+    }
+    return (0);
+}
+
+//!
+//! Has the dhcpd server take the configuration generate_dhcpd_config() wrote: the host
+//! entries go in place through OMAPI when only they changed, dhcpd is restarted otherwise
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int restart_dhcpd_server(void)
 {
     int ret = 0;
     int rc = 0;
@@ -1295,15 +1997,17 @@ int kick_dhcpd_server()
     char tracefile[EUCA_MAX_PATH] = "";
     char rootwrap[EUCA_MAX_PATH] = "";
     char cmd[EUCA_MAX_PATH] = "";
+    char netpath[EUCA_MAX_PATH] = "";
     struct stat mystat = { 0 };
 
-    rc = generate_dhcpd_config();
-    if (rc) {
-        LOGERROR("unable to generate new dhcp configuration file: check above log errors for details\n");
-        ret = 1;
-    } else if (stat(config->dhcpDaemon, &mystat) != 0) {
+    snprintf(netpath, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT, config->eucahome);
+
+    if (stat(config->dhcpDaemon, &mystat) != 0) {
         LOGERROR("unable to find DHCP daemon binaries: '%s'\n", config->dhcpDaemon);
         ret = 1;
+    } else if (vnetUpdateDHCPHosts(netpath) == EUCA_OK) {
+        // only hosts came or went, the running daemon took them without a restart
+        LOGDEBUG("dhcpd server host entries updated in place\n");
     } else {
         snprintf(pidfile, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT "/euca-dhcp.pid", config->eucahome);
         snprintf(leasefile, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT "/euca-dhcp.leases", config->eucahome);
@@ -1324,12 +2028,12 @@ int kick_dhcpd_server()
             }
         }
 
-        if (stat(leasefile, &mystat) != 0) {
-            LOGDEBUG("creating stub lease file (%s)\n", leasefile);
-            rc = touch(leasefile);
-            if (rc) {
-                LOGWARN("cannot create empty leasefile\n");
-            }
+        // the hosts all have fixed addresses, so the lease file only holds the host entries that came and went through OMAPI
+        LOGDEBUG("creating stub lease file (%s)\n", leasefile);
+        unlink(leasefile);
+        rc = touch(leasefile);
+        if (rc) {
+            LOGWARN("cannot create empty leasefile\n");
         }
 
         snprintf(cmd, EUCA_MAX_PATH, "%s %s -cf %s -lf %s -pf %s -tf %s", rootwrap, config->dhcpDaemon, configfile, leasefile, pidfile, tracefile);
@@ -1340,6 +2044,7 @@ int kick_dhcpd_server()
             ret = 1;
         } else {
             LOGDEBUG("dhcpd server restart command (%s) succeeded\n", cmd);
+            vnetRecordDHCPConf(netpath);
         }
     }
 
@@ -1388,6 +2093,8 @@ int generate_dhcpd_config()
     } else {
 
         fprintf(OFH, "# automatically generated config file for DHCP server\ndefault-lease-time 86400;\nmax-lease-time 86400;\nddns-update-style none;\n\n");
+        snprintf(dhcpd_config_path, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT, config->eucahome);
+        vnetPrintDHCPOmapiConf(OFH, dhcpd_config_path);
         fprintf(OFH, "shared-network euca {\n");
 
         network = hex2dot(nw);
@@ -1622,6 +2329,7 @@ int read_config(void)
     cvals[EUCANETD_CVAL_METADATA_USE_VM_PRIVATE] = configFileValue("METADATA_USE_VM_PRIVATE");
     cvals[EUCANETD_CVAL_METADATA_IP] = configFileValue("METADATA_IP");
     cvals[EUCANETD_CVAL_MIDOSETUPCORE] = configFileValue("MIDOSETUPCORE");
+    cvals[EUCANETD_CVAL_FIREWALL_BACKEND] = configFileValue("FIREWALL_BACKEND");
 
     cvals[EUCANETD_CVAL_MIDOEUCANETDHOST] = configFileValue("MIDOEUCANETDHOST");
     if (!cvals[EUCANETD_CVAL_MIDOEUCANETDHOST]) {
@@ -1713,6 +2421,20 @@ int read_config(void)
         config->vmGatewayIP = 0;
     }
 
+    if (!strcmp(cvals[EUCANETD_CVAL_FIREWALL_BACKEND], "nftables")) {
+        config->nftables = 1;
+        if (config->nc_router && !config->nc_router_ip) {
+            // the gateway ARP replies are an ebtables target nftables has no counterpart of
+            LOGWARN("FIREWALL_BACKEND=nftables needs NC_ROUTER_IP to be set when NC_ROUTER=Y: staying with iptables\n");
+            config->nftables = 0;
+        }
+    } else {
+        if (strcmp(cvals[EUCANETD_CVAL_FIREWALL_BACKEND], "iptables")) {
+            LOGERROR("value specified for FIREWALL_BACKEND is neither 'iptables' nor 'nftables': defaulting to 'iptables'\n");
+        }
+        config->nftables = 0;
+    }
+
     snprintf(config->pubInterface, 32, "%s", cvals[EUCANETD_CVAL_PUBINTERFACE]);
     snprintf(config->privInterface, 32, "%s", cvals[EUCANETD_CVAL_PRIVINTERFACE]);
     snprintf(config->bridgeDev, 32, "%s", cvals[EUCANETD_CVAL_BRIDGE]);
@@ -1787,6 +2509,22 @@ int read_config(void)
             LOGERROR("could not initialize ebt_handler: check above log errors for details\n");
             ret = 1;
         }
+
+        if (config->nftables) {
+            config->nft = malloc(sizeof(nft_handler));
+            if (!config->nft) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
+            rc = nft_handler_init(config->nft, config->cmdprefix);
+            if (!rc) {
+                rc = nft_handler_prepare(config->ipt, config->ebt);
+            }
+            if (rc) {
+                LOGERROR("could not initialize nft_handler: check above log errors for details\n");
+                ret = 1;
+            }
+        }
     } else if (!strcmp(config->vnetMode, "VPCMIDO")) {
         // VPCMIDO mode init
         rc = initialize_mido(mido, config->eucahome, config->midosetupcore, config->midoeucanetdhost, config->midogwhost, config->midogwip, config->midogwiface, config->midopubnw, config->midopubgwip, "169.254.0.0", "17");
@@ -1897,6 +2635,98 @@ int fetch_latest_euca_network(int *update_globalnet)
     return (ret);
 }
 
+//!
+//! Binds the datagram socket on which the NC (or any other writer of the global network info)
+//! tells eucanetd that a new version is in place. Failing to do so is not fatal, eucanetd then
+//! only polls.
+//!
+//! @return 0 on success or 1 on failure
+//!
+//! @see vnetNotifyEucanetd()
+//!
+int init_network_notify(void)
+{
+    struct sockaddr_un addr = { 0 };
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), EUCANETD_NOTIFY_SOCKET, config->eucahome);
+
+    if ((config->notify_fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        LOGWARN("cannot create network info notification socket: %s\n", strerror(errno));
+        return (1);
+    }
+
+    // a previous eucanetd may have left its socket behind
+    unlink(addr.sun_path);
+    if (bind(config->notify_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGWARN("cannot bind network info notification socket '%s': %s\n", addr.sun_path, strerror(errno));
+        close(config->notify_fd);
+        config->notify_fd = -1;
+        return (1);
+    }
+
+    if (chmod(addr.sun_path, 0660)) {
+        LOGWARN("chmod failed: could not change permissions of network info notification socket '%s'\n", addr.sun_path);
+    }
+
+    LOGDEBUG("listening for network info notifications on '%s'\n", addr.sun_path);
+    return (0);
+}
+
+//!
+//! Waits for up to timeout seconds for a notification that a new version of the global network
+//! info is in place. A notification carrying the version that was last fetched is ignored.
+//! Without a notification socket, this simply sleeps.
+//!
+//! @param[in] timeout the number of seconds to wait for
+//!
+//! @return 1 if a new version was announced or 0 if the timeout expired
+//!
+int wait_for_network_notify(int timeout)
+{
+    int rc = 0;
+    int notified = 0;
+    ssize_t len = 0;
+    time_t deadline = 0, now = 0;
+    char version[128] = "";
+    struct pollfd pfd = { 0 };
+
+    if (config->notify_fd < 0) {
+        sleep(timeout);
+        return (0);
+    }
+
+    pfd.fd = config->notify_fd;
+    pfd.events = POLLIN;
+    deadline = time(NULL) + timeout;
+    while (!notified && ((now = time(NULL)) < deadline)) {
+        if ((rc = poll(&pfd, 1, ((deadline - now) * 1000))) < 0) {
+            if (errno != EINTR) {
+                LOGWARN("could not wait on network info notification socket: %s\n", strerror(errno));
+                sleep(deadline - now);
+                return (0);
+            }
+            continue;
+        }
+        if (rc == 0) {
+            break;
+        }
+
+        // drain everything queued up, only the latest version matters
+        while ((len = recv(config->notify_fd, version, (sizeof(version) - 1), MSG_DONTWAIT)) >= 0) {
+            version[len] = '\0';
+            if (!strlen(version) || !config->global_network_info_file.lasthash || strcmp(version, config->global_network_info_file.lasthash)) {
+                notified = 1;
+            }
+        }
+    }
+
+    if (notified) {
+        LOGDEBUG("notified of new network info version '%s'\n", version);
+    }
+    return (notified);
+}
+
 //!
 //! Function description.
 //!
@@ -2027,21 +2857,256 @@ int check_stderr_already_exists(int rc, char *o, char *e)
 }
 
 //!
-//! Function description.
+//! Empties the interface table
 //!
-//! @param[in] mac
+static void iface_table_clear(void)
+{
+    u32 pos = 0;
+    void *val = NULL;
+
+    while (ifaces.byindex && hashtable_next(ifaces.byindex, &pos, NULL, &val))
+        EUCA_FREE(val);
+    hashtable_free(ifaces.byindex);
+    hashtable_free(ifaces.byname);
+    hashtable_free(ifaces.bymac);
+    ifaces.byindex = hashtable_create(0);
+    ifaces.byname = hashtable_create(0);
+    ifaces.bymac = hashtable_create(0);
+}
+
 //!
-//! @return
+//! Makes the key of a MAC in the interface table: the MAC from its first ':' on, in lower case
 //!
-//! @see
+//! @param[in]  mac the MAC
+//! @param[out] key the key, empty if the MAC has no ':'
+//! @param[in]  key_size the size of key
 //!
-//! @pre List of pre-conditions
+static void iface_table_key(const char *mac, char *key, int key_size)
+{
+    int i = 0;
+    const char *p = strchr(mac, ':');
+
+    for (i = 0; p && p[i] && (p[i] != '\n') && (i < (key_size - 1)); i++)
+        key[i] = tolower(p[i]);
+    key[i] = '\0';
+}
+
 //!
-//! @post List of post conditions
+//! Applies an RTM_NEWLINK or RTM_DELLINK message, from a dump or a notification, to the
+//! interface table
 //!
-//! @note
+//! @param[in] nh the message
+//!
+static void iface_table_link(struct nlmsghdr *nh)
+{
+    int attrlen = 0;
+    char index[16] = "";
+    char key[32] = "";
+    const char *name = NULL;
+    const unsigned char *addr = NULL;
+    iface_entry *entry = NULL;
+    struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    struct rtattr *rta = NULL;
+
+    snprintf(index, sizeof(index), "%d", ifi->ifi_index);
+    if ((entry = hashtable_remove(ifaces.byindex, index)) != NULL) {
+        // forget what the interface was, it may have been renamed or readdressed
+        if (hashtable_get(ifaces.byname, entry->name) == entry)
+            hashtable_remove(ifaces.byname, entry->name);
+        iface_table_key(entry->mac, key, sizeof(key));
+        if (key[0] && (hashtable_get(ifaces.bymac, key) == entry))
+            hashtable_remove(ifaces.bymac, key);
+        EUCA_FREE(entry);
+    }
+
+    if (nh->nlmsg_type != RTM_NEWLINK)
+        return;
+
+    attrlen = IFLA_PAYLOAD(nh);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+        if (rta->rta_type == IFLA_IFNAME)
+            name = RTA_DATA(rta);
+        else if ((rta->rta_type == IFLA_ADDRESS) && (RTA_PAYLOAD(rta) == 6))
+            addr = RTA_DATA(rta);
+    }
+
+    if (!name || ((entry = EUCA_ZALLOC(1, sizeof(iface_entry))) == NULL))
+        return;
+
+    entry->ifindex = ifi->ifi_index;
+    euca_strncpy(entry->name, name, sizeof(entry->name));
+    if (addr)
+        snprintf(entry->mac, sizeof(entry->mac), "%02x:%02x:%02x:%02x:%02x:%02x", addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+
+    hashtable_set(ifaces.byindex, index, entry);
+    hashtable_set(ifaces.byname, entry->name, entry);
+    iface_table_key(entry->mac, key, sizeof(key));
+    if (key[0])
+        hashtable_set(ifaces.bymac, key, entry);
+}
+
+//!
+//! Fills the interface table again from a dump of the links. Notifications that come in
+//! during the dump are applied along with it, so none is lost.
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int iface_table_dump(void)
+{
+    ssize_t got = 0;
+    boolean done = FALSE;
+    char reply[16384] = "";
+    struct nlmsghdr *nh = NULL;
+    struct sockaddr_nl sa = { 0 };
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } req;
+
+    iface_table_clear();
+    if (!ifaces.byindex || !ifaces.byname || !ifaces.bymac)
+        return (EUCA_ERROR);
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req.nh.nlmsg_type = RTM_GETLINK;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = time(NULL);
+    req.ifi.ifi_family = AF_UNSPEC;
+    sa.nl_family = AF_NETLINK;
+    if (sendto(ifaces.fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+        return (EUCA_ERROR);
+
+    while (!done) {
+        if ((got = recv(ifaces.fd, reply, sizeof(reply), 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_ERROR);
+        }
+
+        for (nh = (struct nlmsghdr *)reply; NLMSG_OK(nh, got); nh = NLMSG_NEXT(nh, got)) {
+            if (nh->nlmsg_type == NLMSG_ERROR)
+                return (EUCA_ERROR);
+            if ((nh->nlmsg_type == NLMSG_DONE) && (nh->nlmsg_seq == req.nh.nlmsg_seq))
+                done = TRUE;
+            else if ((nh->nlmsg_type == RTM_NEWLINK) || (nh->nlmsg_type == RTM_DELLINK))
+                iface_table_link(nh);
+        }
+    }
+
+    LOGDEBUG("interface table filled with %d interfaces\n", ifaces.byindex->count);
+    return (EUCA_OK);
+}
+
+//!
+//! Brings the interface table up to date: opens it on first use, then applies the link
+//! notifications received since the last lookup. Should notifications have been dropped
+//! for lack of room, the table is filled again from a dump.
+//!
+//! @return EUCA_OK if the table can be used or EUCA_ERROR if the lookups must go through sysfs
+//!
+static int iface_table_sync(void)
+{
+    int rcvbuf = IFACE_TABLE_RCVBUF;
+    ssize_t got = 0;
+    char reply[16384] = "";
+    struct nlmsghdr *nh = NULL;
+    struct sockaddr_nl sa = { 0 };
+
+#ifdef EUCANETD_BENCH
+    // the dry-run benchmark stands in for sysfs, and has no links of its own
+    return (EUCA_ERROR);
+#endif /* EUCANETD_BENCH */
+
+    if (ifaces_failed)
+        return (EUCA_ERROR);
+
+    if (ifaces.fd < 0) {
+        sa.nl_family = AF_NETLINK;
+        sa.nl_groups = RTMGRP_LINK;
+        if (((ifaces.fd = socket(AF_NETLINK, (SOCK_RAW | SOCK_CLOEXEC), NETLINK_ROUTE)) < 0)
+            || bind(ifaces.fd, (struct sockaddr *)&sa, sizeof(sa)) || (iface_table_dump() != EUCA_OK)) {
+            LOGWARN("cannot follow network interfaces over rtnetlink, looking them up in sysfs instead\n");
+            if (ifaces.fd >= 0)
+                close(ifaces.fd);
+            ifaces.fd = -1;
+            ifaces_failed = TRUE;
+            return (EUCA_ERROR);
+        }
+        setsockopt(ifaces.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        return (EUCA_OK);
+    }
+
+    for (;;) {
+        if ((got = recv(ifaces.fd, reply, sizeof(reply), MSG_DONTWAIT)) < 0) {
+            if (errno == EINTR)
+                continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                return (EUCA_OK);
+            if (errno == ENOBUFS) {
+                LOGDEBUG("missed network interface notifications, filling the interface table again\n");
+                if (iface_table_dump() == EUCA_OK)
+                    return (EUCA_OK);
+            }
+            LOGWARN("lost track of network interfaces over rtnetlink, looking them up in sysfs instead\n");
+            close(ifaces.fd);
+            ifaces.fd = -1;
+            ifaces_failed = TRUE;
+            return (EUCA_ERROR);
+        }
+
+        for (nh = (struct nlmsghdr *)reply; NLMSG_OK(nh, got); nh = NLMSG_NEXT(nh, got)) {
+            if ((nh->nlmsg_type == RTM_NEWLINK) || (nh->nlmsg_type == RTM_DELLINK))
+                iface_table_link(nh);
+        }
+    }
+}
+
+//!
+//! Finds the interface of an instance from the instance MAC. The interface of an instance
+//! has the same MAC but for the first octet, so that one is not compared.
+//!
+//! @param[in] mac the MAC of the instance
+//!
+//! @return a newly allocated string with the name of the interface, or NULL if there is none (yet)
+//!
+//! @note the lookup is a hash table hit in the interface table, sysfs is only scanned if
+//!       rtnetlink cannot be used
 //!
 char *mac2interface(char *mac)
+{
+    char key[32] = "";
+    iface_entry *entry = NULL;
+
+    if (!mac) {
+        return (NULL);
+    }
+
+    if (iface_table_sync() != EUCA_OK) {
+        return (mac2interface_sysfs(mac));
+    }
+
+    iface_table_key(mac, key, sizeof(key));
+    if (!key[0]) {
+        LOGDEBUG("skipping: parse error extracting mac (malformed): inputmac=%s\n", mac);
+        return (NULL);
+    }
+
+    if ((entry = hashtable_get(ifaces.bymac, key)) == NULL) {
+        return (NULL);
+    }
+    LOGDEBUG("found: matching mac/interface mapping: interface=%s foundmac=%s inputmac=%s\n", entry->name, entry->mac, mac);
+    return (strdup(entry->name));
+}
+
+//!
+//! Does what mac2interface() does by reading the address of every interface in sysfs
+//!
+//! @param[in] mac the MAC of the instance
+//!
+//! @return a newly allocated string with the name of the interface, or NULL if there is none (yet)
+//!
+static char *mac2interface_sysfs(char *mac)
 {
     int rc = 0;
     int match;
@@ -2059,13 +3124,13 @@ char *mac2interface(char *mac)
         return (NULL);
     }
 
-    DH = opendir("/sys/class/net/");
+    DH = opendir(SYS_CLASS_NET_DIR);
     if (DH) {
         rc = readdir_r(DH, &dent, &result);
         match = 0;
         while (!match && !rc && result) {
             if (strcmp(result->d_name, ".") && strcmp(result->d_name, "..")) {
-                snprintf(mac_file, EUCA_MAX_PATH, "/sys/class/net/%s/address", result->d_name);
+                snprintf(mac_file, EUCA_MAX_PATH, "%s/%s/address", SYS_CLASS_NET_DIR, result->d_name);
                 LOGDEBUG("attempting to read mac from file '%s'\n", mac_file);
                 FH = fopen(mac_file, "r");
                 if (FH) {
@@ -2098,37 +3163,38 @@ char *mac2interface(char *mac)
         }
         closedir(DH);
     } else {
-        LOGERROR("could not open sys dir for read '/sys/class/net/': check permissions\n");
+        LOGERROR("could not open sys dir for read '%s/': check permissions\n", SYS_CLASS_NET_DIR);
         ret = NULL;
     }
     return (ret);
 }
 
 //!
-//! Function description.
-//!
-//! @param[in] dev
-//!
-//! @return
-//!
-//! @see
-//!
-//! @pre List of pre-conditions
+//! Gets the MAC of an interface
 //!
-//! @post List of post conditions
+//! @param[in] dev the name of the interface
 //!
-//! @note
+//! @return a newly allocated string with the MAC, followed by a newline like in
+//!         /sys/class/net/<dev>/address, or NULL if there is no such interface
 //!
 char *interface2mac(char *dev)
 {
     char *ret = NULL;
     char devpath[EUCA_MAX_PATH] = "";
+    iface_entry *entry = NULL;
 
     if (!dev) {
         return (NULL);
     }
 
-    snprintf(devpath, EUCA_MAX_PATH, "/sys/class/net/%s/address", dev);
+    if (iface_table_sync() == EUCA_OK) {
+        if (((entry = hashtable_get(ifaces.byname, dev)) == NULL) || !entry->mac[0] || ((ret = EUCA_ALLOC(strlen(entry->mac) + 2, sizeof(char))) == NULL))
+            return (NULL);
+        sprintf(ret, "%s\n", entry->mac);
+        return (ret);
+    }
+
+    snprintf(devpath, EUCA_MAX_PATH, "%s/%s/address", SYS_CLASS_NET_DIR, dev);
     ret = file2str(devpath);
 
     return (ret);
@@ -2183,6 +3249,11 @@ int flush_all(void)
         EUCA_FREE(ipt);
         EUCA_FREE(ebt);
         EUCA_FREE(ips);
+
+        // nftables
+        if (config->nftables && config->nft) {
+            rc = nft_handler_flush(config->nft);
+        }
     } else if (!strcmp(config->vnetMode, "VPCMIDO")) {
         if (mido) {
             rc = do_midonet_teardown(mido);
@@ -2194,3 +3265,1307 @@ int flush_all(void)
 
     return (ret);
 }
+
+#ifdef EUCANETD_BENCH
+//!
+//! Moves what the stand-in logged about the commands it served since the last collection into
+//! their stages, and into what the current update function spent outside of its own code
+//!
+static void bench_collect(void)
+{
+    int stage = 0;
+    long long usec = 0;
+    char path[EUCA_MAX_PATH] = "";
+    FILE *FH = NULL;
+
+    snprintf(path, EUCA_MAX_PATH, "%s/apply.log", bench_statedir);
+    if ((FH = fopen(path, "r")) == NULL) {
+        return;
+    }
+
+    while (fscanf(FH, "%d %lld", &stage, &usec) == 2) {
+        if ((stage >= 0) && (stage < BENCH_STAGES)) {
+            bench_acc[stage] += usec;
+            bench_ran[stage] = 1;
+            bench_inner_usec += usec;
+        }
+    }
+    fclose(FH);
+    unlink(path);
+}
+
+//!
+//! Accounts a deploy that started at the given time: what the commands it ran took goes to their
+//! apply stages, the rest to the given render stage
+//!
+//! @param[in] stage the render stage of the handler that was deployed
+//! @param[in] started when the deploy started (see mono_time_usec())
+//!
+static void bench_deployed(bench_stage stage, long long started)
+{
+    long long elapsed = (mono_time_usec() - started);
+    long long before = bench_inner_usec;
+
+    bench_collect();
+    bench_acc[stage] += MAX(0, (elapsed - (bench_inner_usec - before)));
+    bench_ran[stage] = 1;
+    bench_inner_usec = (before + elapsed);
+}
+
+//!
+//! Times ipt_handler_deploy() for the benchmark
+//!
+//! @param[in] ipth pointer to the IP table handler structure
+//!
+//! @return what ipt_handler_deploy() returns
+//!
+static int bench_ipt_handler_deploy(ipt_handler * ipth)
+{
+    int rc = 0;
+    long long started = 0;
+
+    bench_collect();
+    started = mono_time_usec();
+    rc = (ipt_handler_deploy) (ipth);
+    bench_deployed(BENCH_STAGE_RENDER_IPT, started);
+    return (rc);
+}
+
+//!
+//! Times ips_handler_deploy() for the benchmark
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] dodelete set to 1 to also destroy the sets that are no longer referenced
+//!
+//! @return what ips_handler_deploy() returns
+//!
+static int bench_ips_handler_deploy(ips_handler * ipsh, int dodelete)
+{
+    int rc = 0;
+    long long started = 0;
+
+    bench_collect();
+    started = mono_time_usec();
+    rc = (ips_handler_deploy) (ipsh, dodelete);
+    bench_deployed(BENCH_STAGE_RENDER_IPS, started);
+    return (rc);
+}
+
+//!
+//! Times ebt_handler_deploy() for the benchmark
+//!
+//! @param[in] ebth pointer to the EB table handler structure
+//!
+//! @return what ebt_handler_deploy() returns
+//!
+static int bench_ebt_handler_deploy(ebt_handler * ebth)
+{
+    int rc = 0;
+    long long started = 0;
+
+    bench_collect();
+    started = mono_time_usec();
+    rc = (ebt_handler_deploy) (ebth);
+    bench_deployed(BENCH_STAGE_RENDER_EBT, started);
+    return (rc);
+}
+
+//!
+//! Times nft_handler_deploy() for the benchmark
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//! @param[in] ipth pointer to the IP table handler structure
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] ebth pointer to the EB table handler structure
+//!
+//! @return what nft_handler_deploy() returns
+//!
+static int bench_nft_handler_deploy(nft_handler * nfth, ipt_handler * ipth, ips_handler * ipsh, ebt_handler * ebth)
+{
+    int rc = 0;
+    long long started = 0;
+
+    bench_collect();
+    started = mono_time_usec();
+    rc = (nft_handler_deploy) (nfth, ipth, ipsh, ebth);
+    bench_deployed(BENCH_STAGE_RENDER_NFT, started);
+    return (rc);
+}
+
+//!
+//! Runs one of the update functions and accounts it, along with what it spent building its rules
+//! outside of the deploys and the commands it ran. The latter includes starting the commands
+//! that are not part of a deploy, e.g. 'ip addr'.
+//!
+//! @param[in] stage the stage of the update function
+//! @param[in] update the update function
+//!
+//! @return what the update function returns
+//!
+static int bench_update(bench_stage stage, int (*update) (void))
+{
+    int rc = 0;
+    long long started = 0;
+    long long elapsed = 0;
+
+    bench_collect();
+    bench_inner_usec = 0;
+    started = mono_time_usec();
+    rc = update();
+    elapsed = (mono_time_usec() - started);
+    bench_collect();
+
+    bench_acc[stage] += elapsed;
+    bench_acc[BENCH_STAGE_MODEL] += MAX(0, (elapsed - bench_inner_usec));
+    bench_ran[stage] = bench_ran[BENCH_STAGE_MODEL] = 1;
+    return (rc);
+}
+
+//!
+//! qsort() comparator of the samples
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return -1, 0 or 1 as a is below, equal to or above b
+//!
+static int bench_compare(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints one machine readable line per stage that ran and a summary line, then drops the samples
+//!
+//! @param[in] out where to print
+//! @param[in] config the benchmark parameters, as key=value pairs
+//! @param[in] failed how many iterations had an update fail
+//! @param[in] xml_bytes the size of the last global network view
+//! @param[in] elapsed_usec the time all iterations took
+//!
+static void bench_report(FILE * out, const char *config, int failed, long xml_bytes, long long elapsed_usec)
+{
+    int i = 0;
+    int j = 0;
+    int iterations = 0;
+    long long total = 0;
+    bench_samples *s = NULL;
+
+    for (i = 0; i < BENCH_STAGES; i++) {
+        s = &(bench_samples_of[i]);
+        if (s->len == 0)
+            continue;
+
+        qsort(s->usec, s->len, sizeof(long long), bench_compare);
+        total = 0;
+        for (j = 0; j < s->len; j++)
+            total += s->usec[j];
+
+#define _PCT(_F)                       (s->usec[MIN(s->len - 1, (int)((_F) * s->len))])
+        fprintf(out, "eucanetd_bench stage=%s %s calls=%d total_us=%lld mean_us=%lld p50_us=%lld p90_us=%lld p99_us=%lld max_us=%lld\n",
+                bench_stage_names[i], config, s->len, total, (total / s->len), _PCT(0.50), _PCT(0.90), _PCT(0.99), _PCT(1.0));
+#undef _PCT
+    }
+
+    iterations = bench_samples_of[BENCH_STAGE_ITERATION].len;
+    fprintf(out, "eucanetd_bench stage=summary %s iterations=%d failed=%d xml_bytes=%ld elapsed_us=%lld updates_per_sec=%.2f\n", config, iterations, failed,
+            xml_bytes, elapsed_usec, ((elapsed_usec > 0) ? (iterations * 1000000.0 / elapsed_usec) : 0.0));
+    fflush(out);
+
+    for (i = 0; i < BENCH_STAGES; i++) {
+        EUCA_FREE(bench_samples_of[i].usec);
+        bzero(&(bench_samples_of[i]), sizeof(bench_samples));
+    }
+}
+
+//!
+//! Looks up a chain of the stand-in state
+//!
+//! @param[in] chains
+//! @param[in] max number of chains
+//! @param[in] table the table of the chain, empty for a set
+//! @param[in] name
+//!
+//! @return a pointer to the chain or NULL if not found
+//!
+static bench_chain *bench_chain_find(bench_chain * chains, int max, const char *table, const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < max; i++) {
+        if (!strcmp(chains[i].table, table) && !strcmp(chains[i].name, name)) {
+            return (&(chains[i]));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Adds a chain to the stand-in state or, if it is there already, sets its policy
+//!
+//! @param[in,out] chains
+//! @param[in,out] max number of chains
+//! @param[in]     table the table of the chain, empty for a set
+//! @param[in]     name
+//! @param[in]     policy the rest of the chain line or the type of the set, NULL to leave it alone
+//!
+//! @return a pointer to the chain, valid until the next chain is added
+//!
+static bench_chain *bench_chain_add(bench_chain ** chains, int *max, const char *table, const char *name, const char *policy)
+{
+    bench_chain *chain = NULL;
+
+    if ((chain = bench_chain_find(*chains, *max, table, name)) == NULL) {
+        if ((chain = EUCA_REALLOC(*chains, (*max + 1), sizeof(bench_chain))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        *chains = chain;
+        chain = &((*chains)[(*max)++]);
+        bzero(chain, sizeof(bench_chain));
+        euca_strncpy(chain->table, table, sizeof(chain->table));
+        euca_strncpy(chain->name, name, sizeof(chain->name));
+    }
+
+    if (policy) {
+        euca_strncpy(chain->policy, policy, sizeof(chain->policy));
+    }
+    return (chain);
+}
+
+//!
+//! Appends a rule to a chain of the stand-in state, or a member to a set
+//!
+//! @param[in] chain
+//! @param[in] rule
+//!
+static void bench_chain_append(bench_chain * chain, const char *rule)
+{
+    if ((chain->rules = EUCA_REALLOC(chain->rules, (chain->max_rules + 1), sizeof(char *))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+    chain->rules[chain->max_rules++] = strdup(rule);
+}
+
+//!
+//! Drops the rules of a chain of the stand-in state
+//!
+//! @param[in] chain
+//!
+static void bench_chain_flush(bench_chain * chain)
+{
+    int i = 0;
+
+    for (i = 0; i < chain->max_rules; i++) {
+        EUCA_FREE(chain->rules[i]);
+    }
+    EUCA_FREE(chain->rules);
+    chain->max_rules = 0;
+}
+
+//!
+//! Removes a chain from the stand-in state
+//!
+//! @param[in]     chains
+//! @param[in,out] max number of chains
+//! @param[in]     chain the chain to remove, which has to be one of chains
+//!
+static void bench_chain_del(bench_chain * chains, int *max, bench_chain * chain)
+{
+    bench_chain_flush(chain);
+    memmove(chain, (chain + 1), ((chains + *max) - (chain + 1)) * sizeof(bench_chain));
+    (*max)--;
+}
+
+//!
+//! Frees the stand-in state
+//!
+//! @param[in] chains (may be NULL)
+//! @param[in] max number of chains
+//!
+static void bench_chains_free(bench_chain * chains, int max)
+{
+    int i = 0;
+
+    for (i = 0; i < max; i++) {
+        bench_chain_flush(&(chains[i]));
+    }
+    EUCA_FREE(chains);
+}
+
+//!
+//! Applies an iptables-restore or ebtables-restore input to the stand-in state: a table is
+//! replaced as a whole unless noflush is set, in which case only the chains it lists change.
+//! The state files are kept in the same format.
+//!
+//! @param[in]     FH the input
+//! @param[in,out] chains
+//! @param[in,out] max number of chains
+//! @param[in]     noflush set to 1 for the semantics of 'iptables-restore --noflush'
+//!
+static void bench_chains_restore(FILE * FH, bench_chain ** chains, int *max, int noflush)
+{
+    int i = 0;
+    char buf[4096] = "";
+    char table[32] = "";
+    char name[128] = "";
+    char *p = NULL;
+    bench_chain *chain = NULL;
+
+    while (fgets(buf, sizeof(buf), FH)) {
+        if ((p = strchr(buf, '\n'))) {
+            *p = '\0';
+        }
+        // the rules saved with counters start with them
+        p = buf;
+        if ((*p == '[') && strchr(p, ']')) {
+            p = (strchr(p, ']') + 1);
+        }
+        while (*p == ' ') {
+            p++;
+        }
+
+        if (*p == '*') {
+            euca_strncpy(table, (p + 1), sizeof(table));
+            for (i = (*max - 1); !noflush && (i >= 0); i--) {
+                if (!strcmp((*chains)[i].table, table)) {
+                    bench_chain_del(*chains, max, &((*chains)[i]));
+                }
+            }
+        } else if ((*p == ':') && (sscanf((p + 1), "%127s", name) == 1)) {
+            for (p += (1 + strlen(name)); *p == ' '; p++) ;
+            // with --noflush, an existing user chain gets flushed while a builtin one only gets its policy set
+            if (noflush && ((chain = bench_chain_find(*chains, *max, table, name)) != NULL) && (chain->policy[0] == '-')) {
+                bench_chain_flush(chain);
+            }
+            bench_chain_add(chains, max, table, name, p);
+        } else if (!strncmp(p, "-F ", 3) && (sscanf((p + 3), "%127s", name) == 1)) {
+            if ((chain = bench_chain_find(*chains, *max, table, name)) != NULL) {
+                bench_chain_flush(chain);
+            }
+        } else if (!strncmp(p, "-X ", 3) && (sscanf((p + 3), "%127s", name) == 1)) {
+            if ((chain = bench_chain_find(*chains, *max, table, name)) != NULL) {
+                bench_chain_del(*chains, max, chain);
+            }
+        } else if (!strncmp(p, "-A ", 3) && (sscanf((p + 3), "%127s", name) == 1)) {
+            for (p += (3 + strlen(name)); *p == ' '; p++) ;
+            bench_chain_append(bench_chain_add(chains, max, table, name, NULL), p);
+        }
+    }
+}
+
+//!
+//! Writes the stand-in state in the iptables-save format, which is also what it keeps its ebtables
+//! state in
+//!
+//! @param[in] FH
+//! @param[in] chains
+//! @param[in] max number of chains
+//! @param[in] counters set to 1 to put counters in front of the rules, as 'iptables-save -c' does
+//!
+static void bench_chains_save(FILE * FH, bench_chain * chains, int max, int counters)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+
+    for (i = 0; i < max; i++) {
+        // each table goes out once, at its first chain
+        for (j = 0; (j < i) && strcmp(chains[j].table, chains[i].table); j++) ;
+        if (j < i)
+            continue;
+
+        fprintf(FH, "*%s\n", chains[i].table);
+        for (j = i; j < max; j++) {
+            if (!strcmp(chains[j].table, chains[i].table)) {
+                fprintf(FH, ":%s %s\n", chains[j].name, chains[j].policy);
+            }
+        }
+        for (j = i; j < max; j++) {
+            for (k = 0; !strcmp(chains[j].table, chains[i].table) && (k < chains[j].max_rules); k++) {
+                fprintf(FH, "%s-A %s %s\n", (counters ? "[0:0] " : ""), chains[j].name, chains[j].rules[k]);
+            }
+        }
+        fprintf(FH, "COMMIT\n");
+    }
+}
+
+//!
+//! Writes a table of the stand-in state the way 'ebtables -L' lists it
+//!
+//! @param[in] FH
+//! @param[in] chains
+//! @param[in] max number of chains
+//! @param[in] table
+//!
+static void bench_chains_list(FILE * FH, bench_chain * chains, int max, const char *table)
+{
+    int i = 0;
+    int j = 0;
+    char policy[64] = "";
+
+    fprintf(FH, "Bridge table: %s\n\n", table);
+    for (i = 0; i < max; i++) {
+        if (strcmp(chains[i].table, table))
+            continue;
+
+        if (sscanf(chains[i].policy, "%63s", policy) != 1) {
+            snprintf(policy, sizeof(policy), "ACCEPT");
+        }
+        fprintf(FH, "Bridge chain: %s, entries: %d, policy: %s\n", chains[i].name, chains[i].max_rules, policy);
+        for (j = 0; j < chains[i].max_rules; j++) {
+            fprintf(FH, "%s\n", chains[i].rules[j]);
+        }
+        fprintf(FH, "\n");
+    }
+}
+
+//!
+//! Applies an 'ipset -! restore' input to the stand-in sets, which are kept in the 'ipset save'
+//! format. With -! the sets that exist already are left alone by 'create'.
+//!
+//! @param[in]     FH the input
+//! @param[in,out] sets
+//! @param[in,out] max number of sets
+//!
+static void bench_sets_restore(FILE * FH, bench_chain ** sets, int *max)
+{
+    char buf[4096] = "";
+    char cmd[16] = "";
+    char name[128] = "";
+    char other[128] = "";
+    char *p = NULL;
+    bench_chain *set = NULL;
+    bench_chain *with = NULL;
+    bench_chain swapped;
+
+    while (fgets(buf, sizeof(buf), FH)) {
+        if ((p = strchr(buf, '\n'))) {
+            *p = '\0';
+        }
+        if (sscanf(buf, "%15s %127s", cmd, name) != 2) {
+            continue;
+        }
+        for (p = (buf + strlen(cmd)); *p == ' '; p++) ;
+        for (p += strlen(name); *p == ' '; p++) ;
+
+        set = bench_chain_find(*sets, *max, "", name);
+        if (!strcmp(cmd, "create")) {
+            if (!set) {
+                bench_chain_add(sets, max, "", name, p);
+            }
+        } else if (!strcmp(cmd, "flush") && set) {
+            bench_chain_flush(set);
+        } else if (!strcmp(cmd, "add") && set) {
+            bench_chain_append(set, p);
+        } else if (!strcmp(cmd, "destroy") && set) {
+            bench_chain_del(*sets, max, set);
+        } else if (!strcmp(cmd, "swap") && set && (sscanf(p, "%127s", other) == 1) && ((with = bench_chain_find(*sets, *max, "", other)) != NULL)) {
+            // the sets trade their type and members, not their names
+            swapped = *set;
+            *set = *with;
+            *with = swapped;
+            euca_strncpy(set->name, name, sizeof(set->name));
+            euca_strncpy(with->name, other, sizeof(with->name));
+        }
+    }
+}
+
+//!
+//! Writes the stand-in sets the way 'ipset save' does
+//!
+//! @param[in] FH
+//! @param[in] sets
+//! @param[in] max number of sets
+//!
+static void bench_sets_save(FILE * FH, bench_chain * sets, int max)
+{
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < max; i++) {
+        fprintf(FH, "create %s %s\n", sets[i].name, sets[i].policy);
+        for (j = 0; j < sets[i].max_rules; j++) {
+            fprintf(FH, "add %s %s\n", sets[i].name, sets[i].rules[j]);
+        }
+    }
+}
+
+//!
+//! Reads a stand-in state file
+//!
+//! @param[in]  file the name of the file in the state directory
+//! @param[in]  sets set to 1 for the ipset state
+//! @param[out] chains set to the newly allocated state
+//! @param[out] max set to the number of chains or sets
+//!
+//! @return 0 on success or 1 if the state file cannot be read
+//!
+static int bench_state_load(const char *file, int sets, bench_chain ** chains, int *max)
+{
+    char path[EUCA_MAX_PATH] = "";
+    FILE *FH = NULL;
+
+    *chains = NULL;
+    *max = 0;
+    snprintf(path, EUCA_MAX_PATH, "%s/%s", bench_statedir, file);
+    if ((FH = fopen(path, "r")) == NULL) {
+        return (1);
+    }
+
+    if (sets) {
+        bench_sets_restore(FH, chains, max);
+    } else {
+        bench_chains_restore(FH, chains, max, 0);
+    }
+    fclose(FH);
+    return (0);
+}
+
+//!
+//! Replaces a stand-in state file
+//!
+//! @param[in] file the name of the file in the state directory
+//! @param[in] chains the state
+//! @param[in] max number of chains or sets
+//! @param[in] sets set to 1 for the ipset state
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int bench_state_store(const char *file, bench_chain * chains, int max, int sets)
+{
+    char path[EUCA_MAX_PATH] = "";
+    char tmppath[EUCA_MAX_PATH] = "";
+    FILE *FH = NULL;
+
+    snprintf(path, EUCA_MAX_PATH, "%s/%s", bench_statedir, file);
+    snprintf(tmppath, EUCA_MAX_PATH, "%s.tmp", path);
+    if ((FH = fopen(tmppath, "w")) == NULL) {
+        return (1);
+    }
+
+    if (sets) {
+        bench_sets_save(FH, chains, max);
+    } else {
+        bench_chains_save(FH, chains, max, 0);
+    }
+    fclose(FH);
+    return ((rename(tmppath, path) == 0) ? 0 : 1);
+}
+
+//!
+//! Finds the value of an option in a command line
+//!
+//! @param[in] argc
+//! @param[in] argv
+//! @param[in] arg the option
+//!
+//! @return the argument following the option or NULL if the option is not there
+//!
+static char *bench_arg_after(int argc, char **argv, const char *arg)
+{
+    int i = 0;
+
+    for (i = 1; i < (argc - 1); i++) {
+        if (!strcmp(argv[i], arg)) {
+            return (argv[i + 1]);
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Tells whether an argument is part of a command line
+//!
+//! @param[in] argc
+//! @param[in] argv
+//! @param[in] arg
+//!
+//! @return 1 if it is, 0 otherwise
+//!
+static int bench_has_arg(int argc, char **argv, const char *arg)
+{
+    int i = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], arg)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+//!
+//! Works out which stage the time of a command goes to
+//!
+//! @param[in] argc
+//! @param[in] argv the command, starting with the tool
+//!
+//! @return the stage or -1 for a command that is not run at all
+//!
+static int bench_standin_stage(int argc, char **argv)
+{
+    char *tool = ((strrchr(argv[0], '/')) ? (strrchr(argv[0], '/') + 1) : argv[0]);
+
+    if (!strcmp(tool, "arping")) {
+        return (-1);
+    } else if (!strcmp(tool, "iptables-save")) {
+        return (BENCH_STAGE_READBACK);
+    } else if (!strcmp(tool, "iptables-restore")) {
+        return (BENCH_STAGE_APPLY_IPT);
+    } else if (!strcmp(tool, "ipset")) {
+        return (bench_has_arg(argc, argv, "restore") ? BENCH_STAGE_APPLY_IPS : BENCH_STAGE_READBACK);
+    } else if (!strcmp(tool, "ebtables-restore")) {
+        return (BENCH_STAGE_APPLY_EBT);
+    } else if (!strcmp(tool, "ebtables")) {
+        return ((bench_has_arg(argc, argv, "--atomic-save") || bench_has_arg(argc, argv, "-L")) ? BENCH_STAGE_READBACK : BENCH_STAGE_APPLY_EBT);
+    } else if (!strcmp(tool, "nft")) {
+        return (bench_has_arg(argc, argv, "-f") ? BENCH_STAGE_APPLY_NFT : BENCH_STAGE_READBACK);
+    }
+    return (BENCH_STAGE_APPLY_CMDS);
+}
+
+//!
+//! Emulates a command on top of the state kept in the state directory: iptables-save and
+//! iptables-restore [--noflush], ipset save and restore, ebtables-restore and the ebtables
+//! atomic file saves and listings, and 'nft -f', which keeps the last ruleset as it is. Anything
+//! else, e.g. 'ip addr' or the nft listings, succeeds without doing a thing.
+//!
+//! @param[in] argc
+//! @param[in] argv the command, starting with the tool
+//!
+//! @return 0
+//!
+static int bench_emulate(int argc, char **argv)
+{
+    int max = 0;
+    char *file = NULL;
+    char *table = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    char *tool = ((strrchr(argv[0], '/')) ? (strrchr(argv[0], '/') + 1) : argv[0]);
+    bench_chain *chains = NULL;
+    FILE *FH = NULL;
+
+    if (!strcmp(tool, "iptables-save")) {
+        bench_state_load("iptables", 0, &chains, &max);
+        bench_chains_save(stdout, chains, max, 1);
+    } else if (!strcmp(tool, "iptables-restore")) {
+        bench_state_load("iptables", 0, &chains, &max);
+        bench_chains_restore(stdin, &chains, &max, bench_has_arg(argc, argv, "--noflush"));
+        bench_state_store("iptables", chains, max, 0);
+    } else if (!strcmp(tool, "ipset") && bench_has_arg(argc, argv, "save")) {
+        bench_state_load("ipset", 1, &chains, &max);
+        bench_sets_save(stdout, chains, max);
+    } else if (!strcmp(tool, "ipset") && bench_has_arg(argc, argv, "restore")) {
+        bench_state_load("ipset", 1, &chains, &max);
+        bench_sets_restore(stdin, &chains, &max);
+        bench_state_store("ipset", chains, max, 1);
+    } else if (!strcmp(tool, "ebtables-restore")) {
+        bench_state_load("ebtables", 0, &chains, &max);
+        bench_chains_restore(stdin, &chains, &max, 0);
+        bench_state_store("ebtables", chains, max, 0);
+    } else if (!strcmp(tool, "ebtables")) {
+        file = bench_arg_after(argc, argv, "--atomic-file");
+        table = bench_arg_after(argc, argv, "-t");
+        if (file && table && bench_has_arg(argc, argv, "--atomic-save")) {
+            // the atomic files only have to exist, the listings come out of the state
+            if ((FH = fopen(file, "w")) != NULL) {
+                fprintf(FH, "%s\n", table);
+                fclose(FH);
+            }
+        } else if (file && table && bench_has_arg(argc, argv, "-L")) {
+            bench_state_load("ebtables", 0, &chains, &max);
+            bench_chains_list(stdout, chains, max, table);
+        }
+    } else if (!strcmp(tool, "nft") && ((file = bench_arg_after(argc, argv, "-f")) != NULL)) {
+        snprintf(path, EUCA_MAX_PATH, "%s/nftables", bench_statedir);
+        copy_file(file, path);
+    }
+
+    bench_chains_free(chains, max);
+    return (0);
+}
+
+//!
+//! Serves a command one of the handlers runs with the benchmark as their command prefix:
+//! 'eucanetd-bench -X <statedir> [-R] <command...>'. The command is emulated on top of the state
+//! kept in the directory, or run for real with -R, and what it took is logged there for the
+//! benchmark to collect.
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return the exit code of the command
+//!
+static int bench_standin(int argc, char **argv)
+{
+    int i = 3;
+    int rc = 0;
+    int fd = -1;
+    int stage = 0;
+    int status = 0;
+    int apply = 0;
+    long long started = 0;
+    char line[64] = "";
+    char path[EUCA_MAX_PATH] = "";
+    pid_t pid = 0;
+
+    euca_strncpy(bench_statedir, argv[2], EUCA_MAX_PATH);
+    if ((i < argc) && !strcmp(argv[i], "-R")) {
+        apply = 1;
+        i++;
+    }
+    if (i >= argc) {
+        return (1);
+    }
+    // eucanetd does not wait for its arpings, and nothing would answer them on the benchmark devices
+    if ((stage = bench_standin_stage((argc - i), (argv + i))) < 0) {
+        return (0);
+    }
+
+    started = mono_time_usec();
+    if (!apply) {
+        rc = bench_emulate((argc - i), (argv + i));
+    } else if ((pid = fork()) == 0) {
+        execvp(argv[i], (argv + i));
+        _exit(127);
+    } else {
+        rc = (((pid < 0) || (waitpid(pid, &status, 0) < 0) || !WIFEXITED(status)) ? 1 : WEXITSTATUS(status));
+    }
+    snprintf(line, sizeof(line), "%d %lld\n", stage, (mono_time_usec() - started));
+
+    // a single write, so that the lines of the commands run in parallel do not mix
+    snprintf(path, EUCA_MAX_PATH, "%s/apply.log", bench_statedir);
+    if (((fd = open(path, (O_WRONLY | O_CREAT | O_APPEND), 0600)) < 0) || (write(fd, line, strlen(line)) != (ssize_t) strlen(line))) {
+        rc = 1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return (rc);
+}
+
+//!
+//! Writes the synthetic global network view: bench_instances instances spread over bench_secgroups
+//! sec. groups of bench_rules rules each, with the public IPs bench_public_of[] gives them. The
+//! first bench_local instances run on this node (127.0.0.1), the others on remote nodes.
+//!
+//! @param[in]  path
+//! @param[out] bytes set to the size of the file
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int bench_write_network(const char *path, long *bytes)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    u32 priv = 0;
+    u32 privbase = dot2hex("172.16.0.2");
+    u32 pubbase = dot2hex("10.128.0.1");
+    u32 nodebase = dot2hex("10.112.0.1");
+    char *strptra = NULL;
+    char *strptrb = NULL;
+    char node[32] = "";
+    FILE *FH = NULL;
+
+    if ((FH = fopen(path, "w")) == NULL) {
+        LOGERROR("could not open file for write '%s': check permissions\n", path);
+        return (1);
+    }
+
+    fprintf(FH, "<network-data>\n <configuration>\n");
+    fprintf(FH, "  <property name=\"enabledCLCIp\"><value>10.111.0.1</value></property>\n");
+    fprintf(FH, "  <property name=\"instanceDNSDomain\"><value>eucalyptus.internal</value></property>\n");
+    fprintf(FH, "  <property name=\"instanceDNSServers\"><value>10.111.0.2</value></property>\n");
+    fprintf(FH, "  <property name=\"publicIps\">");
+    for (j = 0; j < bench_pool; j++) {
+        strptra = hex2dot(pubbase + j);
+        fprintf(FH, "<value>%s</value>", strptra);
+        EUCA_FREE(strptra);
+    }
+    fprintf(FH, "</property>\n");
+
+    fprintf(FH, "  <property name=\"clusters\">\n   <cluster name=\"bench\">\n");
+    fprintf(FH, "    <property name=\"enabledCCIp\"><value>10.111.0.3</value></property>\n");
+    fprintf(FH, "    <property name=\"macPrefix\"><value>d0:0d</value></property>\n");
+    fprintf(FH, "    <subnet name=\"172.16.0.0\"><property name=\"netmask\"><value>255.255.0.0</value></property>"
+            "<property name=\"gateway\"><value>172.16.0.1</value></property></subnet>\n");
+    fprintf(FH, "    <property name=\"privateIps\">");
+    for (i = 0; i < bench_instances; i++) {
+        strptra = hex2dot(privbase + i);
+        fprintf(FH, "<value>%s</value>", strptra);
+        EUCA_FREE(strptra);
+    }
+    fprintf(FH, "</property>\n    <property name=\"nodes\">\n");
+
+    // the local instances come first, the others fill up the remote nodes in order
+    for (i = 0; i < bench_instances; i = j) {
+        if (i < bench_local) {
+            j = bench_local;
+            snprintf(node, sizeof(node), "127.0.0.1");
+        } else {
+            j = MIN((i + BENCH_INSTANCES_PER_NODE), bench_instances);
+            strptra = hex2dot(nodebase + ((i - bench_local) / BENCH_INSTANCES_PER_NODE));
+            euca_strncpy(node, strptra, sizeof(node));
+            EUCA_FREE(strptra);
+        }
+        fprintf(FH, "     <node name=\"%s\"><instanceIds>", node);
+        for (k = i; k < j; k++) {
+            fprintf(FH, "<value>i-%08x</value>", k);
+        }
+        fprintf(FH, "</instanceIds></node>\n");
+    }
+    fprintf(FH, "    </property>\n   </cluster>\n  </property>\n </configuration>\n");
+
+    fprintf(FH, " <instances>\n");
+    for (i = 0; i < bench_instances; i++) {
+        priv = (privbase + i);
+        strptra = hex2dot(priv);
+        strptrb = hex2dot(pubbase + bench_public_of[i]);
+        fprintf(FH, "  <instance name=\"i-%08x\"><ownerId>bench</ownerId><macAddress>d0:0d:%02x:%02x:%02x:%02x</macAddress>", i, ((priv >> 24) & 0xff),
+                ((priv >> 16) & 0xff), ((priv >> 8) & 0xff), (priv & 0xff));
+        fprintf(FH, "<publicIp>%s</publicIp><privateIp>%s</privateIp><securityGroups><value>sg-%05d</value></securityGroups></instance>\n", strptrb, strptra,
+                (i % bench_secgroups));
+        EUCA_FREE(strptra);
+        EUCA_FREE(strptrb);
+    }
+    fprintf(FH, " </instances>\n");
+
+    fprintf(FH, " <securityGroups>\n");
+    for (i = 0; i < bench_secgroups; i++) {
+        fprintf(FH, "  <securityGroup name=\"sg-%05d\"><ownerId>bench</ownerId><rules>", i);
+        for (k = 0; k < bench_rules; k++) {
+            fprintf(FH, "<value>-P tcp -p %d-%d -s %d.%d.%d.0/24</value>", (1024 + k), (1024 + k), (100 + ((i / 256) % 100)), (i % 256), (k % 256));
+        }
+        fprintf(FH, "</rules></securityGroup>\n");
+    }
+    fprintf(FH, " </securityGroups>\n</network-data>\n");
+
+    *bytes = ftell(FH);
+    fclose(FH);
+    return (0);
+}
+
+//!
+//! Moves the public IPs of the given percentage of the instances, at least one, to free IPs of the pool
+//!
+//! @param[in] churn
+//!
+static void bench_churn(int churn)
+{
+    int i = 0;
+    int j = 0;
+    int n = 0;
+
+    for (n = 0; (churn > 0) && (n < MAX(1, ((bench_instances * churn) / 100))); n++) {
+        i = (rand() % bench_instances);
+        do {
+            j = (rand() % bench_pool);
+        } while (bench_owner_of[j] >= 0);
+
+        bench_owner_of[bench_public_of[i]] = -1;
+        bench_owner_of[j] = i;
+        bench_public_of[i] = j;
+    }
+}
+
+//!
+//! Sets up the bridge and one device per local instance, with the MAC of the instance, for the
+//! interface lookups of update_isolation_rules() to find: dummy devices in the namespace of the
+//! apply mode, or their entries in a stand-in sysfs under the state directory otherwise
+//!
+//! @param[in] apply set to 1 in the apply mode
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int bench_setup_devices(int apply)
+{
+    int i = 0;
+    int rc = 0;
+    u32 priv = 0;
+    char dev[32] = "";
+    char mac[32] = "";
+    char cmd[EUCA_MAX_PATH] = "";
+    char path[EUCA_MAX_PATH] = "";
+
+    if (apply) {
+        rc = (system("ip link set lo up") || system("ip link add " BENCH_DEVICE " type dummy") || system("ip link set " BENCH_DEVICE " up"));
+    } else {
+        snprintf(bench_sys_class_net, EUCA_MAX_PATH, "%s/sys", bench_statedir);
+        snprintf(path, EUCA_MAX_PATH, "%s/" BENCH_DEVICE, bench_sys_class_net);
+        rc = ((mkdir(bench_sys_class_net, 0700) != 0) || (mkdir(path, 0700) != 0));
+        snprintf(path, EUCA_MAX_PATH, "%s/" BENCH_DEVICE "/address", bench_sys_class_net);
+        rc = (rc || (write2file(path, "fe:ee:00:00:00:01\n") != EUCA_OK));
+    }
+
+    for (i = 0; !rc && (i < bench_local); i++) {
+        // the way the hypervisor brings up the interface of a VM with its MAC
+        priv = (dot2hex("172.16.0.2") + i);
+        snprintf(dev, sizeof(dev), "vnb%d", i);
+        snprintf(mac, sizeof(mac), "fe:0d:%02x:%02x:%02x:%02x", ((priv >> 24) & 0xff), ((priv >> 16) & 0xff), ((priv >> 8) & 0xff), (priv & 0xff));
+        if (apply) {
+            snprintf(cmd, EUCA_MAX_PATH, "ip link add %s address %s type dummy", dev, mac);
+            rc = (system(cmd) != 0);
+        } else {
+            snprintf(path, EUCA_MAX_PATH, "%s/%s", bench_sys_class_net, dev);
+            rc = (mkdir(path, 0700) != 0);
+            snprintf(path, EUCA_MAX_PATH, "%s/%s/address", bench_sys_class_net, dev);
+            rc = (rc || (write2file(path, mac) != EUCA_OK));
+        }
+    }
+
+    if (rc) {
+        LOGERROR("could not set up the benchmark devices\n");
+    }
+    return (rc);
+}
+
+//!
+//! Removes what the benchmark left in its state directory, and the directory
+//!
+static void bench_cleanup(void)
+{
+    int i = 0;
+    char path[EUCA_MAX_PATH] = "";
+    static const char *files[] = { "iptables", "ipset", "ebtables", "nftables", "apply.log", "global_network_info.xml", NULL };
+
+    // the dummy devices of the apply mode go away with their namespace
+    if (strcmp(bench_sys_class_net, "/sys/class/net")) {
+        for (i = -1; i < bench_local; i++) {
+            if (i < 0) {
+                snprintf(path, EUCA_MAX_PATH, "%s/" BENCH_DEVICE, bench_sys_class_net);
+            } else {
+                snprintf(path, EUCA_MAX_PATH, "%s/vnb%d", bench_sys_class_net, i);
+            }
+            euca_strncat(path, "/address", EUCA_MAX_PATH);
+            unlink(path);
+            *strrchr(path, '/') = '\0';
+            rmdir(path);
+        }
+        rmdir(bench_sys_class_net);
+    }
+
+    for (i = 0; files[i]; i++) {
+        snprintf(path, EUCA_MAX_PATH, "%s/%s", bench_statedir, files[i]);
+        unlink(path);
+    }
+    rmdir(bench_statedir);
+}
+
+//!
+//! Runs the benchmark again in a network namespace of its own, for the apply mode to only change
+//! the rules of the namespace. The namespace goes away with its devices and rules afterwards.
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return the exit code of the benchmark in the namespace
+//!
+static int bench_run_in_namespace(int argc, char **argv)
+{
+    int i = 0;
+    int rc = 0;
+    int status = 0;
+    char ns[64] = "";
+    char self[EUCA_MAX_PATH] = "";
+    char cmd[EUCA_MAX_PATH] = "";
+    char **nsargv = NULL;
+    ssize_t len = 0;
+    pid_t pid = 0;
+
+    if ((len = readlink("/proc/self/exe", self, (EUCA_MAX_PATH - 1))) <= 0) {
+        printf("ERROR: cannot find the benchmark executable\n");
+        return (1);
+    }
+    self[len] = '\0';
+
+    snprintf(ns, sizeof(ns), "eucanetd-bench-%d", getpid());
+    snprintf(cmd, EUCA_MAX_PATH, "ip netns add %s", ns);
+    if (system(cmd) || ((nsargv = EUCA_ZALLOC((argc + 6), sizeof(char *))) == NULL)) {
+        printf("ERROR: cannot create network namespace %s\n", ns);
+        return (1);
+    }
+
+    // ip netns exec <namespace> <benchmark> <options> -I
+    nsargv[0] = "ip";
+    nsargv[1] = "netns";
+    nsargv[2] = "exec";
+    nsargv[3] = ns;
+    nsargv[4] = self;
+    for (i = 1; i < argc; i++) {
+        nsargv[4 + i] = argv[i];
+    }
+    nsargv[4 + argc] = "-I";
+
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+        execvp(nsargv[0], nsargv);
+        _exit(127);
+    }
+    rc = (((pid < 0) || (waitpid(pid, &status, 0) < 0) || !WIFEXITED(status)) ? 1 : WEXITSTATUS(status));
+
+    snprintf(cmd, EUCA_MAX_PATH, "ip netns delete %s", ns);
+    if (system(cmd)) {
+        printf("WARNING: cannot delete network namespace %s\n", ns);
+    }
+    EUCA_FREE(nsargv);
+    return (rc);
+}
+
+//!
+//! Benchmarks the EDGE mode control plane. Every iteration writes a synthetic global network
+//! view, moves some public IPs around and then goes through the steps the main loop takes on
+//! an update: read_latest_network() and gni_populate(), the diff against the last update, and
+//! update_sec_groups(), update_public_ips() and update_isolation_rules() with their deploys.
+//!
+//! The handlers get the benchmark as their command prefix. In the default dry-run mode, it
+//! emulates iptables, ipset and ebtables on top of files and the timings are those of parsing
+//! the view, building the rules and rendering them. With -a the benchmark runs in a network
+//! namespace of its own, with a dummy device per local instance, and times the real
+//! iptables-restore, ipset and ebtables runs too. This needs root and the tools. With -N the
+//! rules go through the nftables backend instead, with the NC router on an IP of its own, which
+//! that backend needs.
+//!
+//! Usage: eucanetd-bench [-n instances] [-m secgroups] [-k rules_per_group] [-l local_instances]
+//!                       [-p public_ip_churn_percent] [-i iterations] [-a] [-N] [-o file]
+//!
+//! @param[in] argc
+//! @param[in] argv
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int do_benchmark(int argc, char **argv)
+{
+    int i = 0;
+    int j = 0;
+    int ch = 0;
+    int rc = 0;
+    int apply = 0;
+    int inner = 0;
+    int nftables = 0;
+    int failed = 0;
+    int update_failed = 0;
+    int update_secgroups = 0;
+    int update_node = 0;
+    int churn = BENCH_DEFAULT_CHURN;
+    int iterations = BENCH_DEFAULT_ITERATIONS;
+    long xml_bytes = 0;
+    long long started = 0;
+    long long diff_started = 0;
+    long long elapsed = 0;
+    char desc[256] = "";
+    char self[EUCA_MAX_PATH] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char *outpath = NULL;
+    ssize_t len = 0;
+    gni_node *myself = NULL;
+    globalNetworkInfo *swapgni = NULL;
+    bench_samples *s = NULL;
+    FILE *out = stdout;
+
+    while ((ch = getopt(argc, argv, "n:m:k:l:p:i:aNIo:")) != -1) {
+        switch (ch) {
+        case 'n':
+            bench_instances = atoi(optarg);
+            break;
+        case 'm':
+            bench_secgroups = atoi(optarg);
+            break;
+        case 'k':
+            bench_rules = atoi(optarg);
+            break;
+        case 'l':
+            bench_local = atoi(optarg);
+            break;
+        case 'p':
+            churn = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'a':
+            apply = 1;
+            break;
+        case 'N':
+            nftables = 1;
+            break;
+        case 'I':
+            inner = 1;
+            break;
+        case 'o':
+            outpath = optarg;
+            break;
+        default:
+            printf("Usage: eucanetd-bench [-n instances] [-m secgroups] [-k rules_per_group] [-l local_instances] [-p public_ip_churn_percent] [-i iterations] [-a] [-N]"
+                   " [-o file]\n");
+            return (1);
+        }
+    }
+
+    if ((bench_instances < 1) || (bench_instances > BENCH_MAX_INSTANCES) || (bench_secgroups < 1) || (bench_secgroups > bench_instances) || (bench_rules < 1)
+        || (bench_local < 0) || (bench_local > bench_instances) || (churn < 0) || (churn > 100) || (iterations < 1)) {
+        printf("ERROR: need 1-%d instances, 1 to as many sec. groups as instances, at least one rule per group, no more local instances than instances,"
+               " a churn of 0-100%% and at least one iteration\n", BENCH_MAX_INSTANCES);
+        return (1);
+    }
+
+    if (apply && !inner) {
+        if (geteuid() != 0) {
+            printf("ERROR: the apply mode creates a network namespace and has to run as root\n");
+            return (1);
+        }
+        return (bench_run_in_namespace(argc, argv));
+    }
+
+    if (outpath && ((out = fopen(outpath, "a")) == NULL)) {
+        printf("ERROR: cannot open %s\n", outpath);
+        return (1);
+    }
+    logfile(NULL, EUCA_LOG_WARN, 4);
+
+    snprintf(bench_statedir, EUCA_MAX_PATH, "/tmp/eucanetd-bench-XXXXXX");
+    if (((len = readlink("/proc/self/exe", self, (EUCA_MAX_PATH - 1))) <= 0) || !mkdtemp(bench_statedir)) {
+        printf("ERROR: cannot set up the benchmark state directory\n");
+        return (1);
+    }
+    self[len] = '\0';
+
+    // the handlers run everything through the stand-in, which emulates the commands or times the real ones
+    snprintf(config->cmdprefix, EUCA_MAX_PATH, "%s -X %s%s", self, bench_statedir, (apply ? " -R" : ""));
+    snprintf(config->vnetMode, sizeof(config->vnetMode), "EDGE");
+    snprintf(config->bridgeDev, sizeof(config->bridgeDev), BENCH_DEVICE);
+    snprintf(config->pubInterface, sizeof(config->pubInterface), BENCH_DEVICE);
+    snprintf(config->global_network_info_file.dest, EUCA_MAX_PATH, "%s/global_network_info.xml", bench_statedir);
+    config->nc_router = 1;
+    if (nftables) {
+        // the ARP replies the NC router makes without an IP of its own have no nftables counterpart
+        config->nftables = 1;
+        config->nc_router_ip = 1;
+        snprintf(config->ncRouterIP, sizeof(config->ncRouterIP), "172.16.0.1");
+    }
+
+    if (!apply) {
+        snprintf(path, EUCA_MAX_PATH, "%s/iptables", bench_statedir);
+        rc = (write2file(path, "*filter\n:INPUT ACCEPT [0:0]\n:FORWARD ACCEPT [0:0]\n:OUTPUT ACCEPT [0:0]\nCOMMIT\n"
+                         "*nat\n:PREROUTING ACCEPT [0:0]\n:INPUT ACCEPT [0:0]\n:OUTPUT ACCEPT [0:0]\n:POSTROUTING ACCEPT [0:0]\nCOMMIT\n") != EUCA_OK);
+        snprintf(path, EUCA_MAX_PATH, "%s/ebtables", bench_statedir);
+        rc = (rc || (write2file(path, "*filter\n:INPUT ACCEPT\n:FORWARD ACCEPT\n:OUTPUT ACCEPT\n*nat\n:PREROUTING ACCEPT\n:OUTPUT ACCEPT\n:POSTROUTING ACCEPT\n") != EUCA_OK));
+    }
+    rc = (rc || bench_setup_devices(apply));
+
+    bench_pool = (bench_instances + (bench_instances / 4) + 1);
+    bench_public_of = EUCA_ZALLOC(bench_instances, sizeof(int));
+    bench_owner_of = EUCA_ZALLOC(bench_pool, sizeof(int));
+    config->ipt = EUCA_ZALLOC(1, sizeof(ipt_handler));
+    config->ips = EUCA_ZALLOC(1, sizeof(ips_handler));
+    config->ebt = EUCA_ZALLOC(1, sizeof(ebt_handler));
+    if (rc || !bench_public_of || !bench_owner_of || !config->ipt || !config->ips || !config->ebt || ipt_handler_init(config->ipt, config->cmdprefix)
+        || ips_handler_init(config->ips, config->cmdprefix) || ebt_handler_init(config->ebt, config->cmdprefix)) {
+        printf("ERROR: cannot set up the benchmark\n");
+        rc = 1;
+    }
+    if (!rc && nftables && (((config->nft = EUCA_ZALLOC(1, sizeof(nft_handler))) == NULL) || nft_handler_init(config->nft, config->cmdprefix)
+                            || nft_handler_prepare(config->ipt, config->ebt))) {
+        printf("ERROR: cannot set up the nftables backend\n");
+        rc = 1;
+    }
+
+    for (i = 0; i < bench_pool; i++) {
+        bench_owner_of[i] = ((i < bench_instances) ? i : -1);
+    }
+    for (i = 0; i < bench_instances; i++) {
+        bench_public_of[i] = i;
+    }
+
+    snprintf(desc, sizeof(desc), "instances=%d secgroups=%d rules=%d local=%d churn=%d mode=%s backend=%s", bench_instances, bench_secgroups, bench_rules, bench_local,
+             churn, (apply ? "apply" : "dry"), (nftables ? "nftables" : "iptables"));
+    printf("replaying %s\n", desc);
+    fflush(stdout);                    // or the stand-ins would print it again
+
+    for (i = 0; !rc && (i < iterations); i++) {
+        if (i > 0) {
+            bench_churn(churn);
+        }
+        if ((rc = bench_write_network(config->global_network_info_file.dest, &xml_bytes)) != 0) {
+            break;
+        }
+
+        bzero(bench_acc, sizeof(bench_acc));
+        bzero(bench_ran, sizeof(bench_ran));
+        bench_collect();
+        started = mono_time_usec();
+
+        // the same steps as the EDGE branch of the main loop, with the first update being a full one
+        update_failed = read_latest_network();
+        bench_acc[BENCH_STAGE_PARSE] = (mono_time_usec() - started);
+        bench_ran[BENCH_STAGE_PARSE] = 1;
+
+        if (!update_failed) {
+            diff_started = mono_time_usec();
+            update_secgroups = update_node = 0;
+            gni_delta_clear(&globalnetworkdelta);
+            if ((i == 0) || gni_diff(lastglobalnetworkinfo, globalnetworkinfo, &globalnetworkdelta)) {
+                globalnetworkdelta.full = 1;
+            }
+            if (!gni_delta_is_empty(&globalnetworkdelta)) {
+                update_secgroups = (globalnetworkdelta.full || globalnetworkdelta.config_changed || globalnetworkdelta.max_added_instances
+                                    || globalnetworkdelta.max_removed_instances || globalnetworkdelta.max_modified_instances || globalnetworkdelta.max_added_secgroups
+                                    || globalnetworkdelta.max_removed_secgroups || globalnetworkdelta.max_modified_secgroups);
+                myself = NULL;
+                gni_find_self_node(globalnetworkinfo, &myself);
+                update_node = (!myself || gni_delta_touches_node(&globalnetworkdelta, lastglobalnetworkinfo, globalnetworkinfo, myself->name));
+            }
+            bench_acc[BENCH_STAGE_DIFF] = (mono_time_usec() - diff_started);
+            bench_ran[BENCH_STAGE_DIFF] = 1;
+
+            if (update_secgroups) {
+                update_failed |= bench_update(BENCH_STAGE_SECGROUPS, update_sec_groups);
+            }
+            if (update_secgroups || update_node || globalnetworkdelta.public_ips_changed) {
+                update_failed |= bench_update(BENCH_STAGE_PUBLICIPS, update_public_ips);
+                if (update_node) {
+                    update_failed |= bench_update(BENCH_STAGE_ISOLATION, update_isolation_rules);
+                }
+            }
+        }
+
+        bench_acc[BENCH_STAGE_ITERATION] = (mono_time_usec() - started);
+        bench_ran[BENCH_STAGE_ITERATION] = 1;
+        elapsed += bench_acc[BENCH_STAGE_ITERATION];
+        for (j = 0; j < BENCH_STAGES; j++) {
+            s = &(bench_samples_of[j]);
+            if (bench_ran[j] && ((s->usec = EUCA_REALLOC(s->usec, (s->len + 1), sizeof(long long))) == NULL)) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            } else if (bench_ran[j]) {
+                s->usec[s->len++] = bench_acc[j];
+            }
+        }
+
+        // what has been applied is what the next changes get compared to
+        if (update_failed) {
+            failed++;
+        } else {
+            swapgni = lastglobalnetworkinfo;
+            lastglobalnetworkinfo = globalnetworkinfo;
+            globalnetworkinfo = swapgni;
+        }
+    }
+
+    if (!rc) {
+        bench_report(out, desc, failed, xml_bytes, elapsed);
+    }
+
+    bench_cleanup();
+    EUCA_FREE(bench_public_of);
+    EUCA_FREE(bench_owner_of);
+    if (out != stdout)
+        fclose(out);
+    return ((rc || failed) ? 1 : 0);
+}
+#endif /* EUCANETD_BENCH */
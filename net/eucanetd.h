@@ -79,6 +79,7 @@
 
 #include <data.h>
 #include <ipt_handler.h>
+#include <nft_handler.h>
 #include <atomic_file.h>
 #include <globalnetwork.h>
 
@@ -112,6 +113,7 @@ typedef struct eucanetdConfig_t {
     ipt_handler *ipt;
     ips_handler *ips;
     ebt_handler *ebt;
+    nft_handler *nft;                  //!< applies the ipt/ips/ebt models as one nftables ruleset when nftables is set
 
     char *eucahome, *eucauser;
     char cmdprefix[EUCA_MAX_PATH];
@@ -132,9 +134,11 @@ typedef struct eucanetdConfig_t {
     char midopubgwip[HOSTNAME_SIZE];
 
     atomic_file global_network_info_file;
+    int notify_fd;                     //!< datagram socket new network info versions are announced on, -1 when not listening
 
     // these are flags that can be set by values in eucalyptus.conf
     int polling_frequency, disable_l2_isolation, nc_router_ip, nc_router, metadata_use_vm_private, metadata_ip;
+    int nftables;                      //!< set when FIREWALL_BACKEND is 'nftables'
 
     int debug, flushmode;
     char vnetMode[32];
@@ -169,6 +173,9 @@ int fetch_latest_localconfig(void);
 int fetch_latest_serviceIps(int *);
 int fetch_latest_euca_network(int *update_globalnet);
 
+int init_network_notify(void);
+int wait_for_network_notify(int timeout);
+
 int parse_network_topology(char *);
 int parse_pubprivmap(char *pubprivmap_file);
 int parse_ccpubprivmap(char *cc_configfile);
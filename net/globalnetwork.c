@@ -30,10 +30,45 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <libxml/xmlreader.h>
 
 #include <globalnetwork.h>
 #include <eucalyptus.h>
 #include <hash.h>
+#include <euca_file.h>
+#include <euca_probe.h>
+
+#define GNI_PARSE_MAX_DEPTH                      32     //!< deepest element nesting gni_populate() follows
+#define GNI_PARSE_MAX_PATH                       2048   //!< longest element path gni_populate() follows
+#define GNI_MIN_INDEX_SIZE                       64     //!< initial number of buckets in the GNI name indexes
+
+//! element paths of the objects in the network information document
+#define GNI_XP_INSTANCE                          "/network-data/instances/instance"
+#define GNI_XP_SECGROUP                          "/network-data/securityGroups/securityGroup"
+#define GNI_XP_VPC                               "/network-data/vpcs/vpc"
+#define GNI_XP_VPC_DEPTH                         3      //!< nesting depth of GNI_XP_VPC
+#define GNI_XP_CONFIG                            "/network-data/configuration"
+#define GNI_XP_CLUSTER                           GNI_XP_CONFIG "/property[clusters]/cluster"
+#define GNI_XP_NODE                              GNI_XP_CLUSTER "/property[nodes]/node"
+
+//! state of the streaming parse done by gni_populate()
+typedef struct gni_parser_t {
+    globalNetworkInfo *gni;
+    char path[GNI_PARSE_MAX_PATH];     //!< path of the current element, with property elements as property[<name>]
+    int pathlen[GNI_PARSE_MAX_DEPTH];  //!< length of the path at each depth
+    int gottext[GNI_PARSE_MAX_DEPTH];  //!< set once the element at that depth had its text
+    int depth;
+    gni_instance *instance;            //!< objects the values being parsed belong to, if any
+    gni_secgroup *secgroup;
+    gni_rule *rule;
+    gni_vpc *vpc;
+    gni_vpcsubnet *vpcsubnet;
+    gni_subnet *subnet;
+    gni_cluster *cluster;
+    gni_node *node;
+    char **iplist;                     //!< IPs collected for the publicIps or privateIps property being parsed
+    int max_iplist;
+} gni_parser;
 
 int gni_secgroup_get_chainname(globalNetworkInfo * gni, gni_secgroup * secgroup, char **outchainname)
 {
@@ -94,9 +129,57 @@ int gni_find_self_cluster(globalNetworkInfo * gni, gni_cluster ** outclusterptr)
     return (1);
 }
 
+//!
+//! Gathers the IPs configured on all the local network devices
+//!
+//! @param[out] outips the local IPs, to be freed by the caller
+//! @param[out] outmax number of IPs in outips
+//!
+//! @return 0 on success or 1 if the devices could not be listed
+//!
+static int gni_get_self_ips(u32 ** outips, int *outmax)
+{
+    DIR *DH = NULL;
+    struct dirent dent, *result = NULL;
+    int max = 0, rc, i;
+    u32 *ips = NULL, *nms = NULL;
+
+    *outips = NULL;
+    *outmax = 0;
+
+    DH = opendir("/sys/class/net/");
+    if (!DH) {
+        LOGERROR("could not open directory /sys/class/net/ for read: check permissions\n");
+        return (1);
+    }
+
+    rc = readdir_r(DH, &dent, &result);
+    while (!rc && result) {
+        if (strcmp(dent.d_name, ".") && strcmp(dent.d_name, "..")) {
+            rc = getdevinfo(dent.d_name, &ips, &nms, &max);
+            if (max > 0) {
+                *outips = realloc(*outips, sizeof(u32) * (*outmax + max));
+                for (i = 0; i < max; i++) {
+                    (*outips)[(*outmax)++] = ips[i];
+                }
+            }
+            EUCA_FREE(ips);
+            EUCA_FREE(nms);
+            max = 0;
+        }
+        rc = readdir_r(DH, &dent, &result);
+    }
+    closedir(DH);
+
+    return (0);
+}
+
 int gni_find_self_node(globalNetworkInfo * gni, gni_node ** outnodeptr)
 {
-    int i, j;
+    int i, max_ips = 0;
+    u32 *ips = NULL;
+    char *strptra = NULL;
+    gni_node *node = NULL;
 
     if (!gni || !outnodeptr) {
         LOGERROR("invalid input\n");
@@ -105,24 +188,31 @@ int gni_find_self_node(globalNetworkInfo * gni, gni_node ** outnodeptr)
 
     *outnodeptr = NULL;
 
-    for (i = 0; i < gni->max_clusters; i++) {
-        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
-            if (!gni_is_self(gni->clusters[i].nodes[j].name)) {
-                *outnodeptr = &(gni->clusters[i].nodes[j]);
-                return (0);
+    // the local IPs are gathered once and looked up by name, rather than listing the devices for every node
+    if (gni_get_self_ips(&ips, &max_ips)) {
+        return (1);
+    }
+
+    for (i = 0; i < max_ips; i++) {
+        strptra = hex2dot(ips[i]);
+        if (strptra) {
+            node = gni_find_node(gni, strptra);
+            EUCA_FREE(strptra);
+            if (node) {
+                *outnodeptr = node;
+                break;
             }
         }
     }
+    EUCA_FREE(ips);
 
-    return (1);
+    return ((*outnodeptr) ? 0 : 1);
 }
 
 int gni_is_self(char *test_ip)
 {
-    DIR *DH = NULL;
-    struct dirent dent, *result = NULL;
-    int max, rc, i;
-    u32 *outips = NULL, *outnms = NULL;
+    int i, max_ips = 0;
+    u32 *ips = NULL;
     char *strptra = NULL;
 
     if (!test_ip) {
@@ -130,35 +220,22 @@ int gni_is_self(char *test_ip)
         return (1);
     }
 
-    DH = opendir("/sys/class/net/");
-    if (!DH) {
-        LOGERROR("could not open directory /sys/class/net/ for read: check permissions\n");
+    if (gni_get_self_ips(&ips, &max_ips)) {
         return (1);
     }
 
-    rc = readdir_r(DH, &dent, &result);
-    while (!rc && result) {
-        if (strcmp(dent.d_name, ".") && strcmp(dent.d_name, "..")) {
-            rc = getdevinfo(dent.d_name, &outips, &outnms, &max);
-            for (i = 0; i < max; i++) {
-                strptra = hex2dot(outips[i]);
-                if (strptra) {
-                    if (!strcmp(strptra, test_ip)) {
-                        EUCA_FREE(strptra);
-                        EUCA_FREE(outips);
-                        EUCA_FREE(outnms);
-                        closedir(DH);
-                        return (0);
-                    }
-                    EUCA_FREE(strptra);
-                }
+    for (i = 0; i < max_ips; i++) {
+        strptra = hex2dot(ips[i]);
+        if (strptra) {
+            if (!strcmp(strptra, test_ip)) {
+                EUCA_FREE(strptra);
+                EUCA_FREE(ips);
+                return (0);
             }
-            EUCA_FREE(outips);
-            EUCA_FREE(outnms);
+            EUCA_FREE(strptra);
         }
-        rc = readdir_r(DH, &dent, &result);
     }
-    closedir(DH);
+    EUCA_FREE(ips);
 
     return (1);
 }
@@ -339,8 +416,8 @@ int gni_cluster_get_nodes(globalNetworkInfo * gni, gni_cluster * cluster, char *
 int gni_node_get_instances(globalNetworkInfo * gni, gni_node * node, char **instance_names, int max_instance_names, char ***out_instance_names, int *out_max_instance_names,
                            gni_instance ** out_instances, int *out_max_instances)
 {
-    int ret = 0, getall = 0, i = 0, j = 0, k = 0, retcount = 0, do_outnames = 0, do_outstructs = 0;
-    gni_instance *ret_instances = NULL;
+    int ret = 0, getall = 0, i = 0, j = 0, retcount = 0, do_outnames = 0, do_outstructs = 0;
+    gni_instance *ret_instances = NULL, *instance = NULL;
     char **ret_instance_names = NULL;
 
     if (!gni) {
@@ -388,11 +465,8 @@ int gni_node_get_instances(globalNetworkInfo * gni, gni_node * node, char **inst
             if (do_outnames)
                 ret_instance_names[i] = strdup(node->instance_names[i].name);
             if (do_outstructs) {
-                for (k = 0; k < gni->max_instances; k++) {
-                    if (!strcmp(gni->instances[k].name, node->instance_names[i].name)) {
-                        memcpy(&(ret_instances[i]), &(gni->instances[k]), sizeof(gni_instance));
-                        break;
-                    }
+                if ((instance = gni_find_instance(gni, node->instance_names[i].name)) != NULL) {
+                    memcpy(&(ret_instances[i]), instance, sizeof(gni_instance));
                 }
             }
             retcount++;
@@ -405,13 +479,10 @@ int gni_node_get_instances(globalNetworkInfo * gni, gni_node * node, char **inst
                         ret_instance_names[retcount] = strdup(node->instance_names[i].name);
                     }
                     if (do_outstructs) {
-                        for (k = 0; k < gni->max_instances; k++) {
-                            if (!strcmp(gni->instances[k].name, node->instance_names[i].name)) {
-                                *out_instances = realloc(*out_instances, sizeof(gni_instance) * (retcount + 1));
-                                ret_instances = *out_instances;
-                                memcpy(&(ret_instances[retcount]), &(gni->instances[k]), sizeof(gni_instance));
-                                break;
-                            }
+                        if ((instance = gni_find_instance(gni, node->instance_names[i].name)) != NULL) {
+                            *out_instances = realloc(*out_instances, sizeof(gni_instance) * (retcount + 1));
+                            ret_instances = *out_instances;
+                            memcpy(&(ret_instances[retcount]), instance, sizeof(gni_instance));
                         }
                     }
                     retcount++;
@@ -431,8 +502,8 @@ int gni_node_get_instances(globalNetworkInfo * gni, gni_node * node, char **inst
 int gni_instance_get_secgroups(globalNetworkInfo * gni, gni_instance * instance, char **secgroup_names, int max_secgroup_names, char ***out_secgroup_names,
                                int *out_max_secgroup_names, gni_secgroup ** out_secgroups, int *out_max_secgroups)
 {
-    int ret = 0, getall = 0, i = 0, j = 0, k = 0, retcount = 0, do_outnames = 0, do_outstructs = 0;
-    gni_secgroup *ret_secgroups = NULL;
+    int ret = 0, getall = 0, i = 0, j = 0, retcount = 0, do_outnames = 0, do_outstructs = 0;
+    gni_secgroup *ret_secgroups = NULL, *secgroup = NULL;
     char **ret_secgroup_names = NULL;
 
     if (!gni || !instance) {
@@ -480,11 +551,8 @@ int gni_instance_get_secgroups(globalNetworkInfo * gni, gni_instance * instance,
             if (do_outnames)
                 ret_secgroup_names[i] = strdup(instance->secgroup_names[i].name);
             if (do_outstructs) {
-                for (k = 0; k < gni->max_secgroups; k++) {
-                    if (!strcmp(gni->secgroups[k].name, instance->secgroup_names[i].name)) {
-                        memcpy(&(ret_secgroups[i]), &(gni->secgroups[k]), sizeof(gni_secgroup));
-                        break;
-                    }
+                if ((secgroup = gni_find_secgroup(gni, instance->secgroup_names[i].name)) != NULL) {
+                    memcpy(&(ret_secgroups[i]), secgroup, sizeof(gni_secgroup));
                 }
             }
             retcount++;
@@ -497,13 +565,10 @@ int gni_instance_get_secgroups(globalNetworkInfo * gni, gni_instance * instance,
                         ret_secgroup_names[retcount] = strdup(instance->secgroup_names[i].name);
                     }
                     if (do_outstructs) {
-                        for (k = 0; k < gni->max_secgroups; k++) {
-                            if (!strcmp(gni->secgroups[k].name, instance->secgroup_names[i].name)) {
-                                *out_secgroups = realloc(*out_secgroups, sizeof(gni_secgroup) * (retcount + 1));
-                                ret_secgroups = *out_secgroups;
-                                memcpy(&(ret_secgroups[retcount]), &(gni->secgroups[k]), sizeof(gni_secgroup));
-                                break;
-                            }
+                        if ((secgroup = gni_find_secgroup(gni, instance->secgroup_names[i].name)) != NULL) {
+                            *out_secgroups = realloc(*out_secgroups, sizeof(gni_secgroup) * (retcount + 1));
+                            ret_secgroups = *out_secgroups;
+                            memcpy(&(ret_secgroups[retcount]), secgroup, sizeof(gni_secgroup));
                         }
                     }
                     retcount++;
@@ -523,8 +588,8 @@ int gni_instance_get_secgroups(globalNetworkInfo * gni, gni_instance * instance,
 int gni_secgroup_get_instances(globalNetworkInfo * gni, gni_secgroup * secgroup, char **instance_names, int max_instance_names, char ***out_instance_names,
                                int *out_max_instance_names, gni_instance ** out_instances, int *out_max_instances)
 {
-    int ret = 0, getall = 0, i = 0, j = 0, k = 0, retcount = 0, do_outnames = 0, do_outstructs = 0;
-    gni_instance *ret_instances = NULL;
+    int ret = 0, getall = 0, i = 0, j = 0, retcount = 0, do_outnames = 0, do_outstructs = 0;
+    gni_instance *ret_instances = NULL, *instance = NULL;
     char **ret_instance_names = NULL;
 
     if (!gni || !secgroup) {
@@ -572,11 +637,8 @@ int gni_secgroup_get_instances(globalNetworkInfo * gni, gni_secgroup * secgroup,
             if (do_outnames)
                 ret_instance_names[i] = strdup(secgroup->instance_names[i].name);
             if (do_outstructs) {
-                for (k = 0; k < gni->max_instances; k++) {
-                    if (!strcmp(gni->instances[k].name, secgroup->instance_names[i].name)) {
-                        memcpy(&(ret_instances[i]), &(gni->instances[k]), sizeof(gni_instance));
-                        break;
-                    }
+                if ((instance = gni_find_instance(gni, secgroup->instance_names[i].name)) != NULL) {
+                    memcpy(&(ret_instances[i]), instance, sizeof(gni_instance));
                 }
             }
             retcount++;
@@ -589,13 +651,10 @@ int gni_secgroup_get_instances(globalNetworkInfo * gni, gni_secgroup * secgroup,
                         ret_instance_names[retcount] = strdup(secgroup->instance_names[i].name);
                     }
                     if (do_outstructs) {
-                        for (k = 0; k < gni->max_instances; k++) {
-                            if (!strcmp(gni->instances[k].name, secgroup->instance_names[i].name)) {
-                                *out_instances = realloc(*out_instances, sizeof(gni_instance) * (retcount + 1));
-                                ret_instances = *out_instances;
-                                memcpy(&(ret_instances[retcount]), &(gni->instances[k]), sizeof(gni_instance));
-                                break;
-                            }
+                        if ((instance = gni_find_instance(gni, secgroup->instance_names[i].name)) != NULL) {
+                            *out_instances = realloc(*out_instances, sizeof(gni_instance) * (retcount + 1));
+                            ret_instances = *out_instances;
+                            memcpy(&(ret_instances[retcount]), instance, sizeof(gni_instance));
                         }
                     }
                     retcount++;
@@ -696,651 +755,1071 @@ globalNetworkInfo *gni_init()
     return (gni);
 }
 
-int gni_populate(globalNetworkInfo * gni, char *xmlpath)
+//!
+//! Computes the home bucket of a name in one of the GNI name indexes
+//!
+//! @param[in] key the name to hash
+//! @param[in] index_size number of buckets in the index (power of 2)
+//!
+//! @return the bucket number
+//!
+static int gni_index_bucket(const char *key, int index_size)
 {
-    int rc;
-    xmlDocPtr docptr;
-    xmlXPathContextPtr ctxptr;
-    char expression[2048], *strptra = NULL;
-    char **results = NULL;
-    int max_results = 0, i, j, k, l;
+    unsigned int h = 2166136261U;      // FNV-1a
 
-    if (!gni) {
-        LOGERROR("invalid input\n");
-        return (1);
+    for (; *key != '\0'; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619U;
     }
+    return ((int)(h & (index_size - 1)));
+}
 
-    gni_clear(gni);
+//!
+//! Builds a name index (open addressing, entries are the array position + 1) over
+//! max_entries entries whose names start at keys and are stride bytes apart. Entries
+//! are reached through refs instead when it is not NULL. The first of several entries
+//! with the same name wins, which is what the linear scans it replaces returned.
+//!
+//! @param[out] pindex pointer to the new index buckets
+//! @param[out] pindex_size pointer to the number of buckets in the index
+//! @param[in]  keys pointer to the name of the first entry
+//! @param[in]  stride size of one entry
+//! @param[in]  refs array of pointers to the entries (may be NULL)
+//! @param[in]  max_entries number of entries
+//!
+static void gni_index_build(int **pindex, int *pindex_size, const char *keys, size_t stride, gni_node ** refs, int max_entries)
+{
+    int i, b, size = GNI_MIN_INDEX_SIZE;
+    const char *key = NULL;
 
-    xmlInitParser();
-    LIBXML_TEST_VERSION docptr = xmlParseFile(xmlpath);
-    if (docptr == NULL) {
-        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
-        return (1);
+    EUCA_FREE(*pindex);
+    *pindex_size = 0;
+
+    while ((max_entries * 2) > size) {
+        size *= 2;
+    }
+    if ((*pindex = EUCA_ZALLOC(size, sizeof(int))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
     }
+    *pindex_size = size;
 
-    ctxptr = xmlXPathNewContext(docptr);
-    if (ctxptr == NULL) {
-        LOGERROR("unable to get new xml context\n");
-        xmlFreeDoc(docptr);
-        return (1);
+    for (i = 0; i < max_entries; i++) {
+        key = (refs ? refs[i]->name : (keys + (i * stride)));
+        for (b = gni_index_bucket(key, size); (*pindex)[b] != 0; b = ((b + 1) & (size - 1))) {
+            if (!strcmp((refs ? refs[(*pindex)[b] - 1]->name : (keys + (((*pindex)[b] - 1) * stride))), key)) {
+                break;
+            }
+        }
+        if ((*pindex)[b] == 0) {
+            (*pindex)[b] = i + 1;
+        }
     }
+}
 
-    LOGDEBUG("begin parsing XML into data structures\n");
+//!
+//! Looks up a name in one of the GNI name indexes
+//!
+//! @param[in] index the index buckets (may be NULL)
+//! @param[in] index_size number of buckets in the index
+//! @param[in] keys pointer to the name of the first entry
+//! @param[in] stride size of one entry
+//! @param[in] refs array of pointers to the entries (may be NULL)
+//! @param[in] key the name to look for
+//!
+//! @return the array position of the entry or -1 if not found
+//!
+static int gni_index_find(int *index, int index_size, const char *keys, size_t stride, gni_node ** refs, const char *key)
+{
+    int b;
 
-    // begin instance
-    snprintf(expression, 2048, "/network-data/instances/instance");
-    rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-    gni->instances = EUCA_ZALLOC(max_results, sizeof(gni_instance));
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->instances[i].name, 16, "%s", results[i]);
-        EUCA_FREE(results[i]);
-    }
-    gni->max_instances = max_results;
-    EUCA_FREE(results);
-
-    for (j = 0; j < gni->max_instances; j++) {
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/ownerId", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->instances[j].accountId, 128, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/macAddress", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            mac2hex(results[i], gni->instances[j].macAddress);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/publicIp", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->instances[j].publicIp = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/privateIp", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->instances[j].privateIp = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/vpc", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->instances[j].vpc, 16, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/subnet", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->instances[j].subnet, 16, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/instances/instance[@name='%s']/securityGroups/value", gni->instances[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        gni->instances[j].secgroup_names = EUCA_ZALLOC(max_results, sizeof(gni_name));
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->instances[j].secgroup_names[i].name, 1024, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        gni->instances[j].max_secgroup_names = max_results;
-        EUCA_FREE(results);
-    }
-
-    // end instance, begin secgroup
-    snprintf(expression, 2048, "/network-data/securityGroups/securityGroup");
-    rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-    gni->secgroups = EUCA_ZALLOC(max_results, sizeof(gni_secgroup));
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->secgroups[i].name, 128, "%s", results[i]);
-        EUCA_FREE(results[i]);
-    }
-    gni->max_secgroups = max_results;
-    EUCA_FREE(results);
-
-    for (j = 0; j < gni->max_secgroups; j++) {
-
-        // populate secgroup's instance_names
-        gni->secgroups[j].max_instance_names = 0;
-        gni->secgroups[j].instance_names = EUCA_ZALLOC(gni->max_instances, sizeof(gni_name));
-        for (k = 0; k < gni->max_instances; k++) {
-            for (l = 0; l < gni->instances[k].max_secgroup_names; l++) {
-                if (!strcmp(gni->instances[k].secgroup_names[l].name, gni->secgroups[j].name)) {
-                    //      gni->secgroups[j].instance_names = realloc(gni->secgroups[j].instance_names, sizeof(gni_name) * (gni->secgroups[j].max_instance_names + 1));
-                    snprintf(gni->secgroups[j].instance_names[gni->secgroups[j].max_instance_names].name, 1024, "%s", gni->instances[k].name);
-                    gni->secgroups[j].max_instance_names++;
-                }
-            }
+    for (b = gni_index_bucket(key, index_size); index[b] != 0; b = ((b + 1) & (index_size - 1))) {
+        if (!strcmp((refs ? refs[index[b] - 1]->name : (keys + ((index[b] - 1) * stride))), key)) {
+            return (index[b] - 1);
         }
+    }
+    return (-1);
+}
 
-        snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ownerId", gni->secgroups[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->secgroups[j].accountId, 128, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/rules/value", gni->secgroups[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        gni->secgroups[j].grouprules = EUCA_ZALLOC(max_results, sizeof(gni_name));
-        for (i = 0; i < max_results; i++) {
-            char newrule[2048];
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            rc = ruleconvert(results[i], newrule);
-            if (!rc) {
-                snprintf(gni->secgroups[j].grouprules[i].name, 1024, "%s", newrule);
-            }
-            EUCA_FREE(results[i]);
-        }
-        gni->secgroups[j].max_grouprules = max_results;
-        EUCA_FREE(results);
-
-        int found = 0;
-        int count = 0;
-        while (!found) {
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/protocol", gni->secgroups[j].name, count + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            if (!max_results) {
-                found = 1;
-            } else {
-                count++;
-            }
-            for (i = 0; i < max_results; i++) {
-                EUCA_FREE(results[i]);
-            }
-            EUCA_FREE(results);
+//!
+//! Finds an instance by name
+//!
+//! @param[in] gni a pointer to the global network information structure
+//! @param[in] name the instance ID to look for
+//!
+//! @return a pointer to the instance or NULL if not found
+//!
+gni_instance *gni_find_instance(globalNetworkInfo * gni, char *name)
+{
+    int i;
+
+    if (!gni || !name) {
+        return (NULL);
+    }
+
+    if (gni->instance_index && gni->instances) {
+        i = gni_index_find(gni->instance_index, gni->instance_index_size, gni->instances[0].name, sizeof(gni_instance), NULL, name);
+        return ((i >= 0) ? &(gni->instances[i]) : NULL);
+    }
+
+    for (i = 0; i < gni->max_instances; i++) {
+        if (!strcmp(gni->instances[i].name, name)) {
+            return (&(gni->instances[i]));
         }
+    }
+    return (NULL);
+}
 
-        gni->secgroups[j].ingress_rules = EUCA_ZALLOC(count, sizeof(gni_rule));
-        gni->secgroups[j].max_ingress_rules = count;
+//!
+//! Finds a security group by name
+//!
+//! @param[in] gni a pointer to the global network information structure
+//! @param[in] name the security group name to look for
+//!
+//! @return a pointer to the security group or NULL if not found
+//!
+gni_secgroup *gni_find_secgroup(globalNetworkInfo * gni, char *name)
+{
+    int i;
 
-        for (k = 0; k < gni->secgroups[j].max_ingress_rules; k++) {
+    if (!gni || !name) {
+        return (NULL);
+    }
+
+    if (gni->secgroup_index && gni->secgroups) {
+        i = gni_index_find(gni->secgroup_index, gni->secgroup_index_size, gni->secgroups[0].name, sizeof(gni_secgroup), NULL, name);
+        return ((i >= 0) ? &(gni->secgroups[i]) : NULL);
+    }
 
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/protocol", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                gni->secgroups[j].ingress_rules[k].protocol = atoi(results[i]);
-                EUCA_FREE(results[i]);
+    for (i = 0; i < gni->max_secgroups; i++) {
+        if (!strcmp(gni->secgroups[i].name, name)) {
+            return (&(gni->secgroups[i]));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Finds a node of any cluster by name
+//!
+//! @param[in] gni a pointer to the global network information structure
+//! @param[in] name the node name (IP) to look for
+//!
+//! @return a pointer to the node or NULL if not found
+//!
+gni_node *gni_find_node(globalNetworkInfo * gni, char *name)
+{
+    int i, j;
+
+    if (!gni || !name) {
+        return (NULL);
+    }
+
+    if (gni->node_index) {
+        i = gni_index_find(gni->node_index, gni->node_index_size, NULL, 0, gni->node_refs, name);
+        return ((i >= 0) ? gni->node_refs[i] : NULL);
+    }
+
+    for (i = 0; i < gni->max_clusters; i++) {
+        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
+            if (!strcmp(gni->clusters[i].nodes[j].name, name)) {
+                return (&(gni->clusters[i].nodes[j]));
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/groupId", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->secgroups[j].ingress_rules[k].groupId, 16, "%s", results[i]);
-                EUCA_FREE(results[i]);
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Builds the name indexes of a freshly parsed GNI and fills in what is derived from the
+//! cross references: each security group's member instances and each instance's node.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//!
+static void gni_index(globalNetworkInfo * gni)
+{
+    int i, j, k;
+    gni_secgroup *secgroup = NULL;
+    gni_instance *instance = NULL;
+    gni_node *node = NULL;
+    char nodehostname[HOSTNAME_SIZE];
+    struct hostent *hent = NULL;
+    struct in_addr addr;
+
+    gni_index_build(&(gni->instance_index), &(gni->instance_index_size), (gni->instances ? gni->instances[0].name : NULL), sizeof(gni_instance), NULL, gni->max_instances);
+    gni_index_build(&(gni->secgroup_index), &(gni->secgroup_index_size), (gni->secgroups ? gni->secgroups[0].name : NULL), sizeof(gni_secgroup), NULL, gni->max_secgroups);
+
+    EUCA_FREE(gni->node_refs);
+    gni->max_node_refs = 0;
+    for (i = 0; i < gni->max_clusters; i++) {
+        gni->max_node_refs += gni->clusters[i].max_nodes;
+    }
+    gni->node_refs = EUCA_ZALLOC(gni->max_node_refs + 1, sizeof(gni_node *));
+    for (i = 0, k = 0; i < gni->max_clusters; i++) {
+        for (j = 0; j < gni->clusters[i].max_nodes; j++) {
+            gni->node_refs[k++] = &(gni->clusters[i].nodes[j]);
+        }
+    }
+    gni_index_build(&(gni->node_index), &(gni->node_index_size), NULL, 0, gni->node_refs, gni->max_node_refs);
+
+    // a security group's instances are the ones that name it, in instance order
+    for (i = 0; i < gni->max_instances; i++) {
+        instance = &(gni->instances[i]);
+        for (j = 0; j < instance->max_secgroup_names; j++) {
+            if ((secgroup = gni_find_secgroup(gni, instance->secgroup_names[j].name)) != NULL) {
+                secgroup->max_instance_names++;
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/groupOwnerId", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->secgroups[j].ingress_rules[k].groupOwnerId, 16, "%s", results[i]);
-                EUCA_FREE(results[i]);
+        }
+    }
+    for (i = 0; i < gni->max_secgroups; i++) {
+        gni->secgroups[i].instance_names = EUCA_ZALLOC(gni->secgroups[i].max_instance_names + 1, sizeof(gni_name));
+        gni->secgroups[i].max_instance_names = 0;
+    }
+    for (i = 0; i < gni->max_instances; i++) {
+        instance = &(gni->instances[i]);
+        for (j = 0; j < instance->max_secgroup_names; j++) {
+            if ((secgroup = gni_find_secgroup(gni, instance->secgroup_names[j].name)) != NULL) {
+                snprintf(secgroup->instance_names[secgroup->max_instance_names].name, 1024, "%s", instance->name);
+                secgroup->max_instance_names++;
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/cidr", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->secgroups[j].ingress_rules[k].cidr, 16, "%s", results[i]);
-                EUCA_FREE(results[i]);
+        }
+    }
+
+    // the node hostname is resolved once per node rather than once per instance
+    for (k = 0; k < gni->max_node_refs; k++) {
+        node = gni->node_refs[k];
+        if (!inet_aton(node->name, &addr)) {
+            snprintf(nodehostname, HOSTNAME_SIZE, "%s", node->name);
+        } else if ((hent = gethostbyaddr((char *)&(addr.s_addr), sizeof(addr.s_addr), AF_INET))) {
+            snprintf(nodehostname, HOSTNAME_SIZE, "%s", hent->h_name);
+        } else {
+            snprintf(nodehostname, HOSTNAME_SIZE, "%s", node->name);
+        }
+
+        for (j = 0; j < node->max_instance_names; j++) {
+            if ((instance = gni_find_instance(gni, node->instance_names[j].name)) != NULL) {
+                snprintf(instance->node, HOSTNAME_SIZE, "%s", node->name);
+                snprintf(instance->nodehostname, HOSTNAME_SIZE, "%s", nodehostname);
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/fromPort", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                gni->secgroups[j].ingress_rules[k].fromPort = atoi(results[i]);
-                EUCA_FREE(results[i]);
+        }
+    }
+}
+
+//!
+//! Appends a zeroed element to one of the GNI arrays, growing it by doubling
+//!
+//! @param[in,out] parray pointer to the array
+//! @param[in,out] pmax pointer to the number of elements in the array
+//! @param[in]     size size of one element
+//!
+//! @return a pointer to the new element
+//!
+static void *gni_append(void *parray, int *pmax, size_t size)
+{
+    void **array = (void **)parray;
+    void *newarray = NULL;
+    int cap = 1;
+
+    // the capacity is the element count rounded up to a power of 2
+    while (cap < *pmax) {
+        cap *= 2;
+    }
+    if ((*pmax == 0) || (*pmax == cap)) {
+        cap = ((*pmax == 0) ? 1 : (cap * 2));
+        if ((newarray = realloc(*array, cap * size)) == NULL) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        *array = newarray;
+    }
+    bzero(((char *)*array) + ((*pmax) * size), size);
+    (*pmax)++;
+    return (((char *)*array) + ((*pmax - 1) * size));
+}
+
+//!
+//! Adds a string to the IP list collected for the property being parsed
+//!
+//! @param[in] parser the parser state
+//! @param[in] text the IP or IP range to add
+//!
+static void gni_parse_add_ip(gni_parser * parser, const char *text)
+{
+    char **entry = gni_append(&(parser->iplist), &(parser->max_iplist), sizeof(char *));
+    *entry = strdup(text);
+}
+
+//!
+//! Hands the collected IP list over to gni_serialize_iprange_list() and resets it
+//!
+//! @param[in]  parser the parser state
+//! @param[out] outlist the serialized list (NULL to just drop the collected list)
+//! @param[out] outmax number of IPs in the serialized list
+//!
+static void gni_parse_flush_ips(gni_parser * parser, u32 ** outlist, int *outmax)
+{
+    int i;
+
+    if (outlist && parser->iplist && parser->max_iplist) {
+        gni_serialize_iprange_list(parser->iplist, parser->max_iplist, outlist, outmax);
+    }
+    for (i = 0; i < parser->max_iplist; i++) {
+        EUCA_FREE(parser->iplist[i]);
+    }
+    EUCA_FREE(parser->iplist);
+    parser->max_iplist = 0;
+}
+
+//!
+//! Handles the start of an element: the objects are created as soon as their element
+//! opens, and become the target of the values found below it.
+//!
+//! @param[in] parser the parser state, with the path already including this element
+//! @param[in] name the value of the element's name attribute (may be NULL)
+//!
+static void gni_parse_object(gni_parser * parser, const char *name)
+{
+    globalNetworkInfo *gni = parser->gni;
+    const char *path = parser->path;
+    gni_subnet *subnet = NULL;
+
+    // ingress rules are the only objects without a name
+    if (parser->secgroup && !strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule")) {
+        parser->rule = gni_append(&(parser->secgroup->ingress_rules), &(parser->secgroup->max_ingress_rules), sizeof(gni_rule));
+        return;
+    }
+
+    if (!name) {
+        return;
+    }
+
+    if (!strcmp(path, GNI_XP_INSTANCE)) {
+        parser->instance = gni_append(&(gni->instances), &(gni->max_instances), sizeof(gni_instance));
+        snprintf(parser->instance->name, 16, "%s", name);
+    } else if (!strcmp(path, GNI_XP_SECGROUP)) {
+        parser->secgroup = gni_append(&(gni->secgroups), &(gni->max_secgroups), sizeof(gni_secgroup));
+        snprintf(parser->secgroup->name, 128, "%s", name);
+    } else if (!strcmp(path, GNI_XP_VPC)) {
+        parser->vpc = gni_append(&(gni->vpcs), &(gni->max_vpcs), sizeof(gni_vpc));
+        parser->vpcsubnet = NULL;
+        snprintf(parser->vpc->name, 16, "%s", name);
+    } else if (parser->vpc && (parser->depth == GNI_XP_VPC_DEPTH + 2) && !strncmp(path, GNI_XP_VPC "/subnets/", strlen(GNI_XP_VPC "/subnets/"))) {
+        parser->vpcsubnet = gni_append(&(parser->vpc->subnets), &(parser->vpc->max_subnets), sizeof(gni_vpcsubnet));
+        snprintf(parser->vpcsubnet->name, 16, "%s", name);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[subnets]/subnet")) {
+        subnet = gni_append(&(gni->subnets), &(gni->max_subnets), sizeof(gni_subnet));
+        subnet->subnet = dot2hex((char *)name);
+        parser->subnet = subnet;
+    } else if (!strcmp(path, GNI_XP_CLUSTER)) {
+        parser->cluster = gni_append(&(gni->clusters), &(gni->max_clusters), sizeof(gni_cluster));
+        parser->node = NULL;
+        snprintf(parser->cluster->name, HOSTNAME_SIZE, "%s", name);
+    } else if (parser->cluster && !strcmp(path, GNI_XP_CLUSTER "/subnet")) {
+        parser->cluster->private_subnet.subnet = dot2hex((char *)name);
+    } else if (parser->cluster && !strcmp(path, GNI_XP_NODE)) {
+        parser->node = gni_append(&(parser->cluster->nodes), &(parser->cluster->max_nodes), sizeof(gni_node));
+        snprintf(parser->node->name, HOSTNAME_SIZE, "%s", name);
+    }
+}
+
+//!
+//! Handles the first text of an element, storing it in the object it belongs to
+//!
+//! @param[in] parser the parser state
+//! @param[in] text the text
+//!
+static void gni_parse_value(gni_parser * parser, const char *text)
+{
+    globalNetworkInfo *gni = parser->gni;
+    const char *path = parser->path;
+    gni_name *entry = NULL;
+    u32 *ip = NULL;
+    char rulebuf[2048], newrule[2048];
+
+    if (parser->instance) {
+        if (!strcmp(path, GNI_XP_INSTANCE "/ownerId")) {
+            snprintf(parser->instance->accountId, 128, "%s", text);
+        } else if (!strcmp(path, GNI_XP_INSTANCE "/macAddress")) {
+            mac2hex((char *)text, parser->instance->macAddress);
+        } else if (!strcmp(path, GNI_XP_INSTANCE "/publicIp")) {
+            parser->instance->publicIp = dot2hex((char *)text);
+        } else if (!strcmp(path, GNI_XP_INSTANCE "/privateIp")) {
+            parser->instance->privateIp = dot2hex((char *)text);
+        } else if (!strcmp(path, GNI_XP_INSTANCE "/vpc")) {
+            snprintf(parser->instance->vpc, 16, "%s", text);
+        } else if (!strcmp(path, GNI_XP_INSTANCE "/subnet")) {
+            snprintf(parser->instance->subnet, 16, "%s", text);
+        } else if (!strcmp(path, GNI_XP_INSTANCE "/securityGroups/value")) {
+            entry = gni_append(&(parser->instance->secgroup_names), &(parser->instance->max_secgroup_names), sizeof(gni_name));
+            snprintf(entry->name, 1024, "%s", text);
+        }
+    } else if (parser->secgroup) {
+        if (!strcmp(path, GNI_XP_SECGROUP "/ownerId")) {
+            snprintf(parser->secgroup->accountId, 128, "%s", text);
+        } else if (!strcmp(path, GNI_XP_SECGROUP "/rules/value")) {
+            // a rule that does not convert still takes its slot, as it always has
+            entry = gni_append(&(parser->secgroup->grouprules), &(parser->secgroup->max_grouprules), sizeof(gni_name));
+            snprintf(rulebuf, 2048, "%s", text);
+            if (!ruleconvert(rulebuf, newrule)) {
+                snprintf(entry->name, 1024, "%s", newrule);
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/toPort", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                gni->secgroups[j].ingress_rules[k].toPort = atoi(results[i]);
-                EUCA_FREE(results[i]);
+        } else if (parser->rule) {
+            if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/protocol")) {
+                parser->rule->protocol = atoi(text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/groupId")) {
+                snprintf(parser->rule->groupId, 16, "%s", text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/groupOwnerId")) {
+                snprintf(parser->rule->groupOwnerId, 16, "%s", text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/cidr")) {
+                snprintf(parser->rule->cidr, 16, "%s", text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/fromPort")) {
+                parser->rule->fromPort = atoi(text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/toPort")) {
+                parser->rule->toPort = atoi(text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/icmpType")) {
+                parser->rule->icmpType = atoi(text);
+            } else if (!strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule/icmpCode")) {
+                parser->rule->icmpCode = atoi(text);
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/icmpType", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                gni->secgroups[j].ingress_rules[k].icmpType = atoi(results[i]);
-                EUCA_FREE(results[i]);
+        }
+    } else if (parser->vpc) {
+        if (parser->vpcsubnet) {
+            path += parser->pathlen[GNI_XP_VPC_DEPTH + 2];
+            if (!strcmp(path, "/ownerId")) {
+                snprintf(parser->vpcsubnet->accountId, 128, "%s", text);
+            } else if (!strcmp(path, "/cidr")) {
+                snprintf(parser->vpcsubnet->cidr, 24, "%s", text);
+            } else if (!strcmp(path, "/cluster")) {
+                snprintf(parser->vpcsubnet->cluster_name, HOSTNAME_SIZE, "%s", text);
+            } else if (!strcmp(path, "/networkAcl")) {
+                snprintf(parser->vpcsubnet->networkAcl_name, 16, "%s", text);
+            } else if (!strcmp(path, "/routeTable")) {
+                snprintf(parser->vpcsubnet->routeTable_name, 16, "%s", text);
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/securityGroups/securityGroup[@name='%s']/ingressRules/rule[%d]/icmpCode", gni->secgroups[j].name, k + 1);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                gni->secgroups[j].ingress_rules[k].icmpCode = atoi(results[i]);
-                EUCA_FREE(results[i]);
+        } else if (!strcmp(path, GNI_XP_VPC "/ownerId")) {
+            snprintf(parser->vpc->accountId, 128, "%s", text);
+        } else if (!strcmp(path, GNI_XP_VPC "/cidr")) {
+            snprintf(parser->vpc->cidr, 24, "%s", text);
+        } else if (!strcmp(path, GNI_XP_VPC "/dhcpOptionSet")) {
+            snprintf(parser->vpc->dhcpOptionSet, 16, "%s", text);
+        }
+    } else if (parser->cluster) {
+        if (parser->node) {
+            if (!strcmp(path, GNI_XP_NODE "/instanceIds/value")) {
+                entry = gni_append(&(parser->node->instance_names), &(parser->node->max_instance_names), sizeof(gni_name));
+                snprintf(entry->name, 1024, "%s", text);
             }
-            EUCA_FREE(results);
+        } else if (!strcmp(path, GNI_XP_CLUSTER "/property[enabledCCIp]/value")) {
+            parser->cluster->enabledCCIp = dot2hex((char *)text);
+        } else if (!strcmp(path, GNI_XP_CLUSTER "/property[macPrefix]/value")) {
+            snprintf(parser->cluster->macPrefix, 8, "%s", text);
+        } else if (!strcmp(path, GNI_XP_CLUSTER "/property[privateIps]/value")) {
+            gni_parse_add_ip(parser, text);
+        } else if (!strcmp(path, GNI_XP_CLUSTER "/subnet/property[netmask]/value")) {
+            parser->cluster->private_subnet.netmask = dot2hex((char *)text);
+        } else if (!strcmp(path, GNI_XP_CLUSTER "/subnet/property[gateway]/value")) {
+            parser->cluster->private_subnet.gateway = dot2hex((char *)text);
+        }
+    } else if (parser->subnet) {
+        if (!strcmp(path, GNI_XP_CONFIG "/property[subnets]/subnet/property[netmask]/value")) {
+            parser->subnet->netmask = dot2hex((char *)text);
+        } else if (!strcmp(path, GNI_XP_CONFIG "/property[subnets]/subnet/property[gateway]/value")) {
+            parser->subnet->gateway = dot2hex((char *)text);
+        }
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[enabledCLCIp]/value")) {
+        gni->enabledCLCIp = dot2hex((char *)text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[instanceDNSDomain]/value")) {
+        snprintf(gni->instanceDNSDomain, HOSTNAME_SIZE, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[mido]/property[eucanetdHost]/value")) {
+        snprintf(gni->EucanetdHost, HOSTNAME_SIZE, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[mido]/property[gatewayHost]/value")) {
+        snprintf(gni->GatewayHost, HOSTNAME_SIZE, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[mido]/property[gatewayIP]/value")) {
+        snprintf(gni->GatewayIP, HOSTNAME_SIZE, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[mido]/property[gatewayInterface]/value")) {
+        snprintf(gni->GatewayInterface, 32, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[mido]/property[publicNetworkCidr]/value")) {
+        snprintf(gni->PublicNetworkCidr, HOSTNAME_SIZE, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[mido]/property[publicGatewayIP]/value")) {
+        snprintf(gni->PublicGatewayIP, HOSTNAME_SIZE, "%s", text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[instanceDNSServers]/value")) {
+        ip = gni_append(&(gni->instanceDNSServers), &(gni->max_instanceDNSServers), sizeof(u32));
+        *ip = dot2hex((char *)text);
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[publicIps]/value")) {
+        gni_parse_add_ip(parser, text);
+    }
+}
 
-        }
+//!
+//! Handles the end of an element: objects stop being the target of values once their
+//! element closes, and collected IP lists are stored.
+//!
+//! @param[in] parser the parser state, with the path still including this element
+//!
+static void gni_parse_close(gni_parser * parser)
+{
+    const char *path = parser->path;
+
+    if (!strcmp(path, GNI_XP_INSTANCE)) {
+        parser->instance = NULL;
+    } else if (!strcmp(path, GNI_XP_SECGROUP)) {
+        parser->secgroup = NULL;
+        parser->rule = NULL;
+    } else if (parser->secgroup && !strcmp(path, GNI_XP_SECGROUP "/ingressRules/rule")) {
+        parser->rule = NULL;
+    } else if (!strcmp(path, GNI_XP_VPC)) {
+        parser->vpc = NULL;
+        parser->vpcsubnet = NULL;
+    } else if (parser->vpcsubnet && (parser->depth == GNI_XP_VPC_DEPTH + 2)) {
+        parser->vpcsubnet = NULL;
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[subnets]/subnet")) {
+        parser->subnet = NULL;
+    } else if (!strcmp(path, GNI_XP_CLUSTER)) {
+        parser->cluster = NULL;
+        parser->node = NULL;
+    } else if (parser->node && !strcmp(path, GNI_XP_NODE)) {
+        parser->node = NULL;
+    } else if (parser->cluster && !strcmp(path, GNI_XP_CLUSTER "/property[privateIps]")) {
+        gni_parse_flush_ips(parser, &(parser->cluster->private_ips), &(parser->cluster->max_private_ips));
+    } else if (!strcmp(path, GNI_XP_CONFIG "/property[publicIps]")) {
+        gni_parse_flush_ips(parser, &(parser->gni->public_ips), &(parser->gni->max_public_ips));
+    }
+}
+
+//!
+//! Adds an element to the parser path. Property elements go in as property[<name>] so that
+//! the configuration values can be told apart by path alone.
+//!
+//! @param[in] parser the parser state
+//! @param[in] element the element name
+//! @param[in] name the element's name attribute (may be NULL)
+//!
+//! @return 0 on success or 1 if the document is nested deeper than the parser handles
+//!
+static int gni_parse_push(gni_parser * parser, const char *element, const char *name)
+{
+    int len = parser->pathlen[parser->depth];
+    int rc = 0;
 
-        /*  for (k=0; k<gni->secgroups[j].max_ingress_rules; k++) {
-           LOGTRACE("HELLO: rule=%d %d %d %d %d %d %s %s %s\n", k, gni->secgroups[j].ingress_rules[k].protocol, gni->secgroups[j].ingress_rules[k].fromPort, gni->secgroups[j].ingress_rules[k].toPort, gni->secgroups[j].ingress_rules[k].icmpType, gni->secgroups[j].ingress_rules[k].icmpCode, gni->secgroups[j].ingress_rules[k].groupId, gni->secgroups[j].ingress_rules[k].groupOwnerId, gni->secgroups[j].ingress_rules[k].cidr);
-           }
-           exit(0); 
-         */
+    if ((parser->depth + 1) >= GNI_PARSE_MAX_DEPTH) {
+        return (1);
     }
 
-    // begin VPC
-    snprintf(expression, 2048, "/network-data/vpcs/vpc");
-    rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-    gni->vpcs = EUCA_ZALLOC(max_results, sizeof(gni_vpc));
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->vpcs[i].name, 16, "%s", results[i]);
-        EUCA_FREE(results[i]);
+    if (!strcmp(element, "property") && name) {
+        rc = snprintf(parser->path + len, GNI_PARSE_MAX_PATH - len, "/property[%s]", name);
+    } else {
+        rc = snprintf(parser->path + len, GNI_PARSE_MAX_PATH - len, "/%s", element);
+    }
+    if ((rc < 0) || (rc >= (GNI_PARSE_MAX_PATH - len))) {
+        parser->path[len] = '\0';
+        return (1);
     }
-    gni->max_vpcs = max_results;
-    EUCA_FREE(results);
 
-    for (j = 0; j < gni->max_vpcs; j++) {
+    parser->depth++;
+    parser->pathlen[parser->depth] = len + rc;
+    parser->gottext[parser->depth] = 0;
+    return (0);
+}
 
-        snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/ownerId", gni->vpcs[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->vpcs[j].accountId, 128, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
+//!
+//! Removes the innermost element from the parser path
+//!
+//! @param[in] parser the parser state
+//!
+static void gni_parse_pop(gni_parser * parser)
+{
+    if (parser->depth > 0) {
+        parser->depth--;
+        parser->path[parser->pathlen[parser->depth]] = '\0';
+    }
+}
 
-        snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/cidr", gni->vpcs[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->vpcs[j].cidr, 24, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
+//!
+//! Populates a given globalNetworkInfo structure from the content of an XML file. The
+//! document is read in a single streaming pass: every element is matched once, by its
+//! path, against the fields it fills.
+//!
+//! @param[in] gni a pointer to the global network information structure
+//! @param[in] xmlpath path to the XML file containing the network information
+//!
+//! @return 0 on success or 1 on failure
+//!
+int gni_populate(globalNetworkInfo * gni, char *xmlpath)
+{
+    int rc = 0;
+    int ret = 0;
+    int empty = 0;
+    char *element = NULL, *name = NULL, *text = NULL;
+    xmlTextReaderPtr reader = NULL;
+    file_view xml = { 0 };
+    gni_parser parser;
 
-        snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/dhcpOptionSet", gni->vpcs[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->vpcs[j].dhcpOptionSet, 16, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
+    if (!gni) {
+        LOGERROR("invalid input\n");
+        return (1);
+    }
 
-        snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/subnets/*", gni->vpcs[j].name);
-        rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-        gni->vpcs[j].subnets = EUCA_ZALLOC(max_results, sizeof(gni_vpcsubnet));
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->vpcs[j].subnets[i].name, 16, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        gni->vpcs[j].max_subnets = max_results;
-        EUCA_FREE(results);
+    EUCA_PROBE1(gni__populate__start, xmlpath);
+    gni_clear(gni);
 
-        for (k = 0; k < gni->vpcs[j].max_subnets; k++) {
+    // the reader streams straight out of the view, no copy of the document is made
+    if (file_view_open(xmlpath, -1, &xml) != EUCA_OK) {
+        LOGERROR("unable to read XML file (%s)\n", xmlpath);
+        EUCA_PROBE2(gni__populate__done, xmlpath, 1);
+        return (1);
+    }
 
-            snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/subnets/subnet[@name='%s']/ownerId", gni->vpcs[j].name, gni->vpcs[j].subnets[k].name);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->vpcs[j].subnets[k].accountId, 128, "%s", results[i]);
-                EUCA_FREE(results[i]);
-            }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/subnets/subnet[@name='%s']/cidr", gni->vpcs[j].name, gni->vpcs[j].subnets[k].name);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->vpcs[j].subnets[k].cidr, 24, "%s", results[i]);
-                EUCA_FREE(results[i]);
-            }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/subnets/subnet[@name='%s']/cluster", gni->vpcs[j].name, gni->vpcs[j].subnets[k].name);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->vpcs[j].subnets[k].cluster_name, HOSTNAME_SIZE, "%s", results[i]);
-                EUCA_FREE(results[i]);
+    xmlInitParser();
+    LIBXML_TEST_VERSION reader = xmlReaderForMemory(xml.data, xml.len, xmlpath, NULL, 0);
+    if (reader == NULL) {
+        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+        file_view_close(&xml);
+        EUCA_PROBE2(gni__populate__done, xmlpath, 1);
+        return (1);
+    }
+
+    LOGDEBUG("begin parsing XML into data structures\n");
+
+    bzero(&parser, sizeof(gni_parser));
+    parser.gni = gni;
+
+    while (!ret && ((rc = xmlTextReaderRead(reader)) == 1)) {
+        switch (xmlTextReaderNodeType(reader)) {
+        case XML_READER_TYPE_ELEMENT:
+            element = (char *)xmlTextReaderConstLocalName(reader);
+            name = (char *)xmlTextReaderGetAttribute(reader, (const xmlChar *)"name");
+            empty = xmlTextReaderIsEmptyElement(reader);
+            if (gni_parse_push(&parser, element, name)) {
+                LOGERROR("XML file (%s) is nested too deeply, at '%s'\n", xmlpath, parser.path);
+                ret = 1;
+            } else {
+                gni_parse_object(&parser, name);
+                if (empty) {
+                    gni_parse_close(&parser);
+                    gni_parse_pop(&parser);
+                }
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/subnets/subnet[@name='%s']/networkAcl", gni->vpcs[j].name, gni->vpcs[j].subnets[k].name);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->vpcs[j].subnets[k].networkAcl_name, 16, "%s", results[i]);
-                EUCA_FREE(results[i]);
+            if (name) {
+                xmlFree(name);
             }
-            EUCA_FREE(results);
-
-            snprintf(expression, 2048, "/network-data/vpcs/vpc[@name='%s']/subnets/subnet[@name='%s']/routeTable", gni->vpcs[j].name, gni->vpcs[j].subnets[k].name);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->vpcs[j].subnets[k].routeTable_name, 16, "%s", results[i]);
-                EUCA_FREE(results[i]);
+            break;
+
+        case XML_READER_TYPE_TEXT:
+        case XML_READER_TYPE_CDATA:
+            // like the XPath lookups before it, only the first text of an element counts
+            if ((parser.depth > 0) && !parser.gottext[parser.depth]) {
+                parser.gottext[parser.depth] = 1;
+                if ((text = (char *)xmlTextReaderConstValue(reader)) != NULL) {
+                    gni_parse_value(&parser, text);
+                }
             }
-            EUCA_FREE(results);
+            break;
 
+        case XML_READER_TYPE_END_ELEMENT:
+            gni_parse_close(&parser);
+            gni_parse_pop(&parser);
+            break;
+
+        default:
+            break;
         }
-        // TODO: networkAcls, routeTables, internetGateways
+    }
 
+    if (!ret && (rc != 0)) {
+        LOGERROR("unable to parse XML file (%s)\n", xmlpath);
+        ret = 1;
     }
 
-    // begin configuration
+    gni_parse_flush_ips(&parser, NULL, NULL);
+    xmlFreeTextReader(reader);
+    xmlCleanupParser();
+    file_view_close(&xml);
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='enabledCLCIp']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        gni->enabledCLCIp = dot2hex(results[i]);
-        EUCA_FREE(results[i]);
+    if (ret) {
+        // do not leave a half parsed document behind
+        gni_clear(gni);
+        EUCA_PROBE2(gni__populate__done, xmlpath, 1);
+        return (1);
     }
-    EUCA_FREE(results);
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='instanceDNSDomain']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->instanceDNSDomain, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
+    gni_index(gni);
+
+    LOGDEBUG("end parsing XML into data structures\n");
+
+    rc = gni_validate(gni);
+    if (rc) {
+        LOGERROR("could not validate GNI after XML parse: check network config\n");
+        EUCA_PROBE2(gni__populate__done, xmlpath, 1);
+        return (1);
     }
-    EUCA_FREE(results);
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='mido']/property[@name='eucanetdHost']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->EucanetdHost, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
+    EUCA_PROBE2(gni__populate__done, xmlpath, 0);
+    return (0);
+}
+
+//!
+//! Compares two lists of names, order included
+//!
+//! @param[in] a first list
+//! @param[in] max_a number of names in a
+//! @param[in] b second list
+//! @param[in] max_b number of names in b
+//!
+//! @return 0 if the lists are the same or 1 if they differ
+//!
+static int gni_names_differ(gni_name * a, int max_a, gni_name * b, int max_b)
+{
+    int i;
+
+    if (max_a != max_b) {
+        return (1);
     }
-    EUCA_FREE(results);
+    for (i = 0; i < max_a; i++) {
+        if (strcmp(a[i].name, b[i].name)) {
+            return (1);
+        }
+    }
+    return (0);
+}
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='mido']/property[@name='gatewayHost']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->GatewayHost, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
+//!
+//! Compares two lists of IPs, order included
+//!
+//! @param[in] a first list
+//! @param[in] max_a number of IPs in a
+//! @param[in] b second list
+//! @param[in] max_b number of IPs in b
+//!
+//! @return 0 if the lists are the same or 1 if they differ
+//!
+static int gni_ips_differ(u32 * a, int max_a, u32 * b, int max_b)
+{
+    if (max_a != max_b) {
+        return (1);
     }
-    EUCA_FREE(results);
+    return ((max_a > 0) && memcmp(a, b, max_a * sizeof(u32)));
+}
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='mido']/property[@name='gatewayIP']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->GatewayIP, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
+//!
+//! Compares everything eucanetd applies from an instance. The node hostname is left out:
+//! it follows from the node and its reverse lookup can change on its own.
+//!
+//! @param[in] a first instance
+//! @param[in] b second instance
+//!
+//! @return 0 if the instances are the same or 1 if they differ
+//!
+static int gni_instance_differs(gni_instance * a, gni_instance * b)
+{
+    if (strcmp(a->accountId, b->accountId) || strcmp(a->vpc, b->vpc) || strcmp(a->subnet, b->subnet) || strcmp(a->node, b->node)) {
+        return (1);
+    }
+    if (memcmp(a->macAddress, b->macAddress, sizeof(a->macAddress)) || (a->publicIp != b->publicIp) || (a->privateIp != b->privateIp)) {
+        return (1);
     }
-    EUCA_FREE(results);
+    return (gni_names_differ(a->secgroup_names, a->max_secgroup_names, b->secgroup_names, b->max_secgroup_names));
+}
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='mido']/property[@name='gatewayInterface']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->GatewayInterface, 32, "%s", results[i]);
-        EUCA_FREE(results[i]);
+//!
+//! Compares the rules and the membership of two security groups
+//!
+//! @param[in] a first security group
+//! @param[in] b second security group
+//!
+//! @return 0 if the security groups are the same or 1 if they differ
+//!
+static int gni_secgroup_differs(gni_secgroup * a, gni_secgroup * b)
+{
+    if (strcmp(a->accountId, b->accountId)) {
+        return (1);
+    }
+    if (gni_names_differ(a->grouprules, a->max_grouprules, b->grouprules, b->max_grouprules)) {
+        return (1);
+    }
+    if (gni_names_differ(a->instance_names, a->max_instance_names, b->instance_names, b->max_instance_names)) {
+        return (1);
+    }
+    // the rules are zeroed before being filled in, so they can be compared whole
+    if ((a->max_ingress_rules != b->max_ingress_rules) || ((a->max_ingress_rules > 0) && memcmp(a->ingress_rules, b->ingress_rules, a->max_ingress_rules * sizeof(gni_rule)))) {
+        return (1);
     }
-    EUCA_FREE(results);
+    return (0);
+}
+
+//!
+//! Compares the cloud wide settings, subnets, clusters, nodes and VPCs of two snapshots.
+//! Which instances run on a node is left out, since that shows up in the instances.
+//!
+//! @param[in] a first snapshot
+//! @param[in] b second snapshot
+//!
+//! @return 0 if they are the same or 1 if they differ
+//!
+static int gni_config_differs(globalNetworkInfo * a, globalNetworkInfo * b)
+{
+    int i, j;
+    gni_cluster *ca = NULL, *cb = NULL;
+    gni_vpc *va = NULL, *vb = NULL;
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='mido']/property[@name='publicNetworkCidr']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->PublicNetworkCidr, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
+    if ((a->enabledCLCIp != b->enabledCLCIp) || strcmp(a->instanceDNSDomain, b->instanceDNSDomain) || strcmp(a->EucanetdHost, b->EucanetdHost)
+        || strcmp(a->GatewayHost, b->GatewayHost) || strcmp(a->GatewayIP, b->GatewayIP) || strcmp(a->GatewayInterface, b->GatewayInterface)
+        || strcmp(a->PublicNetworkCidr, b->PublicNetworkCidr) || strcmp(a->PublicGatewayIP, b->PublicGatewayIP)) {
+        return (1);
+    }
+    if (gni_ips_differ(a->instanceDNSServers, a->max_instanceDNSServers, b->instanceDNSServers, b->max_instanceDNSServers)) {
+        return (1);
+    }
+    if ((a->max_subnets != b->max_subnets) || ((a->max_subnets > 0) && memcmp(a->subnets, b->subnets, a->max_subnets * sizeof(gni_subnet)))) {
+        return (1);
     }
-    EUCA_FREE(results);
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='mido']/property[@name='publicGatewayIP']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->PublicGatewayIP, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
+    if (a->max_clusters != b->max_clusters) {
+        return (1);
+    }
+    for (i = 0; i < a->max_clusters; i++) {
+        ca = &(a->clusters[i]);
+        cb = &(b->clusters[i]);
+        if (strcmp(ca->name, cb->name) || (ca->enabledCCIp != cb->enabledCCIp) || strcmp(ca->macPrefix, cb->macPrefix)
+            || memcmp(&(ca->private_subnet), &(cb->private_subnet), sizeof(gni_subnet)) || (ca->max_nodes != cb->max_nodes)) {
+            return (1);
+        }
+        if (gni_ips_differ(ca->private_ips, ca->max_private_ips, cb->private_ips, cb->max_private_ips)) {
+            return (1);
+        }
+        for (j = 0; j < ca->max_nodes; j++) {
+            if (strcmp(ca->nodes[j].name, cb->nodes[j].name)) {
+                return (1);
+            }
+        }
     }
-    EUCA_FREE(results);
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='instanceDNSServers']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-    gni->instanceDNSServers = EUCA_ZALLOC(max_results, sizeof(u32));
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        gni->instanceDNSServers[i] = dot2hex(results[i]);
-        EUCA_FREE(results[i]);
+    if (a->max_vpcs != b->max_vpcs) {
+        return (1);
+    }
+    for (i = 0; i < a->max_vpcs; i++) {
+        va = &(a->vpcs[i]);
+        vb = &(b->vpcs[i]);
+        if (strcmp(va->name, vb->name) || strcmp(va->accountId, vb->accountId) || strcmp(va->cidr, vb->cidr) || strcmp(va->dhcpOptionSet, vb->dhcpOptionSet)
+            || (va->max_subnets != vb->max_subnets)) {
+            return (1);
+        }
+        // the subnets are zeroed before being filled in, so they can be compared whole
+        if ((va->max_subnets > 0) && memcmp(va->subnets, vb->subnets, va->max_subnets * sizeof(gni_vpcsubnet))) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+//!
+//! Adds a name to one of the lists of a delta
+//!
+//! @param[in,out] plist pointer to the list
+//! @param[in,out] pmax pointer to the number of names in the list
+//! @param[in]     name the name to add
+//!
+static void gni_delta_add(gni_name ** plist, int *pmax, char *name)
+{
+    gni_name *entry = gni_append(plist, pmax, sizeof(gni_name));
+    snprintf(entry->name, 1024, "%s", name);
+}
+
+//!
+//! Works out what changed between two network info snapshots: the instances and security
+//! groups that were added, removed or modified, whether the public IP pool changed, and
+//! whether anything else (settings, subnets, clusters, nodes, VPCs) did. The snapshots are
+//! looked up through their name indexes, so this runs in the size of the snapshots rather
+//! than their square, and the callers can then work in the size of the change.
+//!
+//! @param[in]  oldgni the snapshot that was last applied
+//! @param[in]  newgni the snapshot about to be applied
+//! @param[out] outdelta the changes, to be released with gni_delta_clear()
+//!
+//! @return 0 on success or 1 on failure
+//!
+int gni_diff(globalNetworkInfo * oldgni, globalNetworkInfo * newgni, gni_delta * outdelta)
+{
+    int i;
+    gni_instance *instance = NULL;
+    gni_secgroup *secgroup = NULL;
+
+    if (!oldgni || !newgni || !outdelta) {
+        LOGERROR("invalid input\n");
+        return (1);
     }
-    gni->max_instanceDNSServers = max_results;
-    EUCA_FREE(results);
 
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='publicIps']/value");
-    rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
+    bzero(outdelta, sizeof(gni_delta));
 
-    if (results && max_results) {
-        rc = gni_serialize_iprange_list(results, max_results, &(gni->public_ips), &(gni->max_public_ips));
-        //    gni->public_ips = EUCA_ZALLOC(max_results, sizeof(u32));
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            //        gni->public_ips[i] = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
+    for (i = 0; i < newgni->max_instances; i++) {
+        if ((instance = gni_find_instance(oldgni, newgni->instances[i].name)) == NULL) {
+            gni_delta_add(&(outdelta->added_instances), &(outdelta->max_added_instances), newgni->instances[i].name);
+        } else if (gni_instance_differs(instance, &(newgni->instances[i]))) {
+            gni_delta_add(&(outdelta->modified_instances), &(outdelta->max_modified_instances), newgni->instances[i].name);
         }
-        //    gni->max_public_ips = max_results;
-        EUCA_FREE(results);
-    }
-
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='subnets']/subnet");
-    rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-    gni->subnets = EUCA_ZALLOC(max_results, sizeof(gni_subnet));
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        gni->subnets[i].subnet = dot2hex(results[i]);
-        EUCA_FREE(results[i]);
-    }
-    gni->max_subnets = max_results;
-    EUCA_FREE(results);
-
-    for (j = 0; j < gni->max_subnets; j++) {
-        strptra = hex2dot(gni->subnets[j].subnet);
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='subnets']/subnet[@name='%s']/property[@name='netmask']/value", SP(strptra));
-        EUCA_FREE(strptra);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->subnets[j].netmask = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
+    }
+    for (i = 0; i < oldgni->max_instances; i++) {
+        if (!gni_find_instance(newgni, oldgni->instances[i].name)) {
+            gni_delta_add(&(outdelta->removed_instances), &(outdelta->max_removed_instances), oldgni->instances[i].name);
         }
-        EUCA_FREE(results);
+    }
 
-        strptra = hex2dot(gni->subnets[j].subnet);
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='subnets']/subnet[@name='%s']/property[@name='gateway']/value", SP(strptra));
-        EUCA_FREE(strptra);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->subnets[j].gateway = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-    }
-
-    snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster");
-    rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-    gni->clusters = EUCA_ZALLOC(max_results, sizeof(gni_cluster));
-    for (i = 0; i < max_results; i++) {
-        LOGTRACE("after function: %d: %s\n", i, results[i]);
-        snprintf(gni->clusters[i].name, HOSTNAME_SIZE, "%s", results[i]);
-        EUCA_FREE(results[i]);
-    }
-    gni->max_clusters = max_results;
-    EUCA_FREE(results);
-
-    for (j = 0; j < gni->max_clusters; j++) {
-
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/property[@name='enabledCCIp']/value", gni->clusters[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->clusters[j].enabledCCIp = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/property[@name='macPrefix']/value", gni->clusters[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->clusters[j].macPrefix, 8, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/property[@name='privateIps']/value", gni->clusters[j].name);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        if (results && max_results) {
-            rc = gni_serialize_iprange_list(results, max_results, &(gni->clusters[j].private_ips), &(gni->clusters[j].max_private_ips));
-            //        gni->clusters[j].private_ips = EUCA_ZALLOC(max_results, sizeof(u32));
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                //            gni->clusters[j].private_ips[i] = dot2hex(results[i]);
-                EUCA_FREE(results[i]);
-            }
-            //        gni->clusters[j].max_private_ips = max_results;
-            EUCA_FREE(results);
+    for (i = 0; i < newgni->max_secgroups; i++) {
+        if ((secgroup = gni_find_secgroup(oldgni, newgni->secgroups[i].name)) == NULL) {
+            gni_delta_add(&(outdelta->added_secgroups), &(outdelta->max_added_secgroups), newgni->secgroups[i].name);
+        } else if (gni_secgroup_differs(secgroup, &(newgni->secgroups[i]))) {
+            gni_delta_add(&(outdelta->modified_secgroups), &(outdelta->max_modified_secgroups), newgni->secgroups[i].name);
         }
-
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/subnet", gni->clusters[j].name);
-        rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->clusters[j].private_subnet.subnet = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
+    }
+    for (i = 0; i < oldgni->max_secgroups; i++) {
+        if (!gni_find_secgroup(newgni, oldgni->secgroups[i].name)) {
+            gni_delta_add(&(outdelta->removed_secgroups), &(outdelta->max_removed_secgroups), oldgni->secgroups[i].name);
         }
-        EUCA_FREE(results);
+    }
 
-        strptra = hex2dot(gni->clusters[j].private_subnet.subnet);
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/subnet[@name='%s']/property[@name='netmask']/value",
-                 gni->clusters[j].name, SP(strptra));
-        EUCA_FREE(strptra);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->clusters[j].private_subnet.netmask = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
+    outdelta->public_ips_changed = gni_ips_differ(oldgni->public_ips, oldgni->max_public_ips, newgni->public_ips, newgni->max_public_ips);
+    outdelta->config_changed = gni_config_differs(oldgni, newgni);
+
+    LOGDEBUG("network info changes: instances +%d -%d ~%d, secgroups +%d -%d ~%d, public IPs %s, configuration %s\n", outdelta->max_added_instances,
+             outdelta->max_removed_instances, outdelta->max_modified_instances, outdelta->max_added_secgroups, outdelta->max_removed_secgroups,
+             outdelta->max_modified_secgroups, (outdelta->public_ips_changed ? "changed" : "unchanged"), (outdelta->config_changed ? "changed" : "unchanged"));
+    return (0);
+}
+
+//!
+//! Tells whether a delta has no changes at all
+//!
+//! @param[in] delta the delta to check
+//!
+//! @return 1 if nothing changed or 0 otherwise
+//!
+int gni_delta_is_empty(gni_delta * delta)
+{
+    if (!delta) {
+        return (0);
+    }
+    return (!delta->full && !delta->config_changed && !delta->public_ips_changed && !delta->max_added_instances && !delta->max_removed_instances
+            && !delta->max_modified_instances && !delta->max_added_secgroups && !delta->max_removed_secgroups && !delta->max_modified_secgroups);
+}
+
+//!
+//! Tells whether an instance was added or modified by a delta
+//!
+//! @param[in] delta the changes
+//! @param[in] name the instance ID
+//!
+//! @return 1 if the instance is new or changed or 0 otherwise
+//!
+int gni_delta_has_instance(gni_delta * delta, char *name)
+{
+    int i;
+
+    if (!delta || !name || delta->full) {
+        return (1);
+    }
+
+    for (i = 0; i < delta->max_added_instances; i++) {
+        if (!strcmp(delta->added_instances[i].name, name)) {
+            return (1);
+        }
+    }
+    for (i = 0; i < delta->max_modified_instances; i++) {
+        if (!strcmp(delta->modified_instances[i].name, name)) {
+            return (1);
         }
-        EUCA_FREE(results);
+    }
+    return (0);
+}
 
-        strptra = hex2dot(gni->clusters[j].private_subnet.subnet);
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/subnet[@name='%s']/property[@name='gateway']/value",
-                 gni->clusters[j].name, SP(strptra));
-        EUCA_FREE(strptra);
-        rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            gni->clusters[j].private_subnet.gateway = dot2hex(results[i]);
-            EUCA_FREE(results[i]);
-        }
-        EUCA_FREE(results);
-
-        snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/property[@name='nodes']/node", gni->clusters[j].name);
-        rc = evaluate_xpath_element(ctxptr, expression, &results, &max_results);
-        gni->clusters[j].nodes = EUCA_ZALLOC(max_results, sizeof(gni_node));
-        for (i = 0; i < max_results; i++) {
-            LOGTRACE("after function: %d: %s\n", i, results[i]);
-            snprintf(gni->clusters[j].nodes[i].name, HOSTNAME_SIZE, "%s", results[i]);
-            EUCA_FREE(results[i]);
-        }
-        gni->clusters[j].max_nodes = max_results;
-        EUCA_FREE(results);
-
-        for (k = 0; k < gni->clusters[j].max_nodes; k++) {
-
-            snprintf(expression, 2048, "/network-data/configuration/property[@name='clusters']/cluster[@name='%s']/property[@name='nodes']/node[@name='%s']/instanceIds/value",
-                     gni->clusters[j].name, gni->clusters[j].nodes[k].name);
-            rc = evaluate_xpath_property(ctxptr, expression, &results, &max_results);
-            gni->clusters[j].nodes[k].instance_names = EUCA_ZALLOC(max_results, sizeof(gni_name));
-            for (i = 0; i < max_results; i++) {
-                LOGTRACE("after function: %d: %s\n", i, results[i]);
-                snprintf(gni->clusters[j].nodes[k].instance_names[i].name, 1024, "%s", results[i]);
-                EUCA_FREE(results[i]);
-
-                for (l = 0; l < gni->max_instances; l++) {
-                    if (!strcmp(gni->instances[l].name, gni->clusters[j].nodes[k].instance_names[i].name)) {
-                        snprintf(gni->instances[l].node, HOSTNAME_SIZE, "%s", gni->clusters[j].nodes[k].name);
-                        {
-                            struct hostent *hent;
-                            struct in_addr addr;
-                            char *ip = NULL;
-
-                            ip = strdup(gni->instances[l].node);
-
-                            if (!inet_aton(ip, &addr)) {
-                                snprintf(gni->instances[l].nodehostname, HOSTNAME_SIZE, "%s", ip);
-                            } else if ((hent = gethostbyaddr((char *)&(addr.s_addr), sizeof(addr.s_addr), AF_INET))) {
-                                snprintf(gni->instances[l].nodehostname, HOSTNAME_SIZE, "%s", hent->h_name);
-                            } else {
-                                snprintf(gni->instances[l].nodehostname, HOSTNAME_SIZE, "%s", gni->instances[l].node);
-                            }
-                            EUCA_FREE(ip);
-                        }
-                    }
-                }
+//!
+//! Tells whether a security group was added or modified by a delta
+//!
+//! @param[in] delta the changes
+//! @param[in] name the security group ID
+//!
+//! @return 1 if the security group is new or changed or 0 otherwise
+//!
+int gni_delta_has_secgroup(gni_delta * delta, char *name)
+{
+    int i;
 
-            }
-            gni->clusters[j].nodes[k].max_instance_names = max_results;
-            EUCA_FREE(results);
+    if (!delta || !name || delta->full) {
+        return (1);
+    }
 
+    for (i = 0; i < delta->max_added_secgroups; i++) {
+        if (!strcmp(delta->added_secgroups[i].name, name)) {
+            return (1);
         }
     }
+    for (i = 0; i < delta->max_modified_secgroups; i++) {
+        if (!strcmp(delta->modified_secgroups[i].name, name)) {
+            return (1);
+        }
+    }
+    return (0);
+}
 
-    xmlXPathFreeContext(ctxptr);
-    xmlFreeDoc(docptr);
-    xmlCleanupParser();
+//!
+//! Tells whether a delta changes a given node: its instances, or any setting
+//!
+//! @param[in] delta the changes
+//! @param[in] oldgni the snapshot the delta was computed from
+//! @param[in] newgni the snapshot the delta was computed to
+//! @param[in] nodename the name (IP) of the node
+//!
+//! @return 1 if the node is affected or 0 otherwise
+//!
+int gni_delta_touches_node(gni_delta * delta, globalNetworkInfo * oldgni, globalNetworkInfo * newgni, char *nodename)
+{
+    int i;
+    gni_instance *instance = NULL;
 
-    LOGDEBUG("end parsing XML into data structures\n");
+    if (!delta || !oldgni || !newgni || !nodename || delta->full || delta->config_changed) {
+        return (1);
+    }
 
-    rc = gni_validate(gni);
-    if (rc) {
-        LOGERROR("could not validate GNI after XML parse: check network config\n");
+    for (i = 0; i < delta->max_added_instances; i++) {
+        if ((instance = gni_find_instance(newgni, delta->added_instances[i].name)) && !strcmp(instance->node, nodename)) {
+            return (1);
+        }
+    }
+    for (i = 0; i < delta->max_removed_instances; i++) {
+        if ((instance = gni_find_instance(oldgni, delta->removed_instances[i].name)) && !strcmp(instance->node, nodename)) {
+            return (1);
+        }
+    }
+    // a modified instance may have moved, so both of its nodes are affected
+    for (i = 0; i < delta->max_modified_instances; i++) {
+        if ((instance = gni_find_instance(newgni, delta->modified_instances[i].name)) && !strcmp(instance->node, nodename)) {
+            return (1);
+        }
+        if ((instance = gni_find_instance(oldgni, delta->modified_instances[i].name)) && !strcmp(instance->node, nodename)) {
+            return (1);
+        }
+    }
+    return (0);
+}
+
+//!
+//! Releases the lists of a delta and resets it
+//!
+//! @param[in] delta the delta to clear
+//!
+//! @return 0 on success or 1 on failure
+//!
+int gni_delta_clear(gni_delta * delta)
+{
+    if (!delta) {
         return (1);
     }
 
+    EUCA_FREE(delta->added_instances);
+    EUCA_FREE(delta->removed_instances);
+    EUCA_FREE(delta->modified_instances);
+    EUCA_FREE(delta->added_secgroups);
+    EUCA_FREE(delta->removed_secgroups);
+    EUCA_FREE(delta->modified_secgroups);
+    bzero(delta, sizeof(gni_delta));
     return (0);
 }
 
@@ -1580,6 +2059,10 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
     }
     if (mode == GNI_ITERATE_FREE) {
         EUCA_FREE(gni->vpcs);
+        EUCA_FREE(gni->instance_index);
+        EUCA_FREE(gni->secgroup_index);
+        EUCA_FREE(gni->node_refs);
+        EUCA_FREE(gni->node_index);
     }
 
     if (mode == GNI_ITERATE_FREE) {
@@ -158,8 +158,35 @@ typedef struct globalNetworkInfo_t {
     int max_secgroups;
     gni_vpc *vpcs;
     int max_vpcs;
+    int *instance_index;               //!< name hash index over instances (entries are index + 1), built by gni_populate()
+    int instance_index_size;
+    int *secgroup_index;               //!< name hash index over secgroups
+    int secgroup_index_size;
+    gni_node **node_refs;              //!< all the nodes of all the clusters, in cluster order
+    int max_node_refs;
+    int *node_index;                   //!< name hash index over node_refs
+    int node_index_size;
 } globalNetworkInfo;
 
+//! what changed between two globalNetworkInfo snapshots, see gni_diff()
+typedef struct gni_delta_t {
+    int full;                          //!< set by the caller when everything is to be treated as changed
+    gni_name *added_instances;
+    int max_added_instances;
+    gni_name *removed_instances;
+    int max_removed_instances;
+    gni_name *modified_instances;
+    int max_modified_instances;
+    gni_name *added_secgroups;
+    int max_added_secgroups;
+    gni_name *removed_secgroups;
+    int max_removed_secgroups;
+    gni_name *modified_secgroups;
+    int max_modified_secgroups;
+    int public_ips_changed;            //!< the public IP pool changed
+    int config_changed;                //!< settings, subnets, clusters, nodes or VPCs changed
+} gni_delta;
+
 globalNetworkInfo *gni_init(void);
 int gni_populate(globalNetworkInfo * gni, char *xmlpath);
 int gni_print(globalNetworkInfo * gni);
@@ -174,6 +201,9 @@ int gni_secgroup_clear(gni_secgroup * secgroup);
 int gni_vpc_clear(gni_vpc * vpc);
 
 int gni_is_self(char *test_ip);
+gni_instance *gni_find_instance(globalNetworkInfo * gni, char *name);
+gni_secgroup *gni_find_secgroup(globalNetworkInfo * gni, char *name);
+gni_node *gni_find_node(globalNetworkInfo * gni, char *name);
 int gni_find_self_node(globalNetworkInfo * gni, gni_node ** outnodeptr);
 int gni_find_self_cluster(globalNetworkInfo * gni, gni_cluster ** outclusterptr);
 int gni_secgroup_get_chainname(globalNetworkInfo * gni, gni_secgroup * secgroup, char **outchainname);
@@ -196,6 +226,13 @@ int gni_node_validate(gni_node * node);
 int gni_instance_validate(gni_instance * instance);
 int gni_secgroup_validate(gni_secgroup * secgroup);
 
+int gni_diff(globalNetworkInfo * oldgni, globalNetworkInfo * newgni, gni_delta * outdelta);
+int gni_delta_is_empty(gni_delta * delta);
+int gni_delta_has_instance(gni_delta * delta, char *name);
+int gni_delta_has_secgroup(gni_delta * delta, char *name);
+int gni_delta_touches_node(gni_delta * delta, globalNetworkInfo * oldgni, globalNetworkInfo * newgni, char *nodename);
+int gni_delta_clear(gni_delta * delta);
+
 int gni_serialize_iprange_list(char **inlist, int inmax, u32 ** outlist, int *outmax);
 int evaluate_xpath_property(xmlXPathContextPtr ctxptr, char *expression, char ***results, int *max_results);
 int evaluate_xpath_element(xmlXPathContextPtr ctxptr, char *expression, char ***results, int *max_results);
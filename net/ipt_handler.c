@@ -79,11 +79,13 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <sys/wait.h>
 
 #include <eucalyptus.h>
 #include <log.h>
 #include <vnetwork.h>
 #include <euca_string.h>
+#include <euca_probe.h>
 
 #include "ipt_handler.h"
 
@@ -93,6 +95,13 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define IPT_MIN_CHAINS_SIZE                      8  //!< initial number of chain entries allocated in a table
+#define IPT_MIN_RULES_SIZE                      16  //!< initial number of rule entries allocated in a chain
+#define IPT_MIN_INDEX_SIZE                      32  //!< initial number of buckets of a chain or rule index (power of 2)
+
+#define IPS_SWAP_PREFIX                  "EU_SWAP_"  //!< prefix of the temporary sets built before being swapped in ('_' never shows in a hashed EU_ name)
+#define IPS_SET_TYPE          "hash:net family inet hashsize 2048 maxelem 65536"    //!< type of the sets we create
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -137,6 +146,27 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int ipt_system_restore_noflush(ipt_handler * ipth);
+static int ipt_system_restore_file(ipt_handler * ipth, boolean noflush);
+static void ipt_tables_free(ipt_table * tables, int max_tables);
+static ipt_table *ipt_tables_find_table(ipt_table * tables, int max_tables, char *findtable);
+static ipt_chain *ipt_tables_find_chain(ipt_table * table, char *findchain);
+static int ipt_chain_is_live(ipt_chain * chain);
+static int ipt_handler_snapshot(ipt_handler * ipth, int live_only, ipt_table ** outtables, int *outmax);
+static void ipt_handler_reconcile_deployed(ipt_handler * ipth, ipt_table * deployed, int max_deployed);
+static int ipt_chain_changed(ipt_chain * chain, ipt_chain * deployed);
+static int ipt_handler_deploy_delta(ipt_handler * ipth);
+static int ipt_index_bucket(const char *key, int index_size);
+static int ipt_index_find(int *index, int index_size, const char *keys, size_t stride, const char *key);
+static void ipt_index_insert(int *index, int index_size, const char *keys, size_t stride, int entry);
+static void ipt_index_rebuild(int **pindex, int *pindex_size, const char *keys, size_t stride, int max_entries);
+static unsigned long long ips_set_hash(ips_set * set);
+static void ips_set_write_members(FILE * FH, ips_set * set, char *name);
+static int ips_handler_deploy_swap(ips_handler * ipsh, int dodelete);
+static int ips_handler_deploy_full(ips_handler * ipsh, int dodelete);
+static void ips_handler_mark_deployed(ips_handler * ipsh, int dodelete);
+static int ebt_handler_deploy_batch(ebt_handler * ebth);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -249,15 +279,55 @@ int ipt_system_save(ipt_handler * ipth)
 //!
 int ipt_system_restore(ipt_handler * ipth)
 {
-    int rc;
-    char cmd[EUCA_MAX_PATH];
+    return (ipt_system_restore_file(ipth, FALSE));
+}
 
-    snprintf(cmd, EUCA_MAX_PATH, "%s iptables-restore -c < %s", ipth->cmdprefix, ipth->ipt_file);
-    rc = system(cmd);
-    rc = rc >> 8;
-    if (rc) {
+//!
+//! Applies the partial ruleset in the IP table handler file on top of the current system
+//! rules: only the chains listed in the file are touched.
+//!
+//! @param[in] ipth pointer to the IP table handler structure
+//!
+//! @return 0 on success or the iptables-restore exit code on failure
+//!
+static int ipt_system_restore_noflush(ipt_handler * ipth)
+{
+    return (ipt_system_restore_file(ipth, TRUE));
+}
+
+//!
+//! Feeds the IP table handler file to iptables-restore, without going through a shell
+//!
+//! @param[in] ipth pointer to the IP table handler structure
+//! @param[in] noflush set to TRUE to only touch the chains listed in the file
+//!
+//! @return 0 on success or the iptables-restore exit code on failure
+//!
+static int ipt_system_restore_file(ipt_handler * ipth, boolean noflush)
+{
+    int i = 0;
+    int rc = 0;
+    int status = 0;
+    char prefix[EUCA_MAX_PATH] = "";
+    char *argv[16] = { NULL };
+    char *ptr = NULL;
+    char *tok = NULL;
+
+    // the command prefix (e.g. the rootwrap) may carry arguments of its own
+    euca_strncpy(prefix, ipth->cmdprefix, EUCA_MAX_PATH);
+    for (tok = strtok_r(prefix, " ", &ptr); tok && (i < 12); tok = strtok_r(NULL, " ", &ptr))
+        argv[i++] = tok;
+    argv[i++] = "iptables-restore";
+    argv[i++] = "-c";
+    if (noflush)
+        argv[i++] = "--noflush";
+    argv[i] = NULL;
+
+    if ((rc = euca_run(argv, ipth->ipt_file, 0, 0, NULL, NULL, &status)) != EUCA_OK) {
+        rc = (((rc == EUCA_ERROR) && WIFEXITED(status)) ? WEXITSTATUS(status) : 1);
         copy_file(ipth->ipt_file, "/tmp/euca_ipt_file_failed");
-        LOGERROR("iptables-restore failed '%s': copying failed input file to '/tmp/euca_ipt_file_failed' for manual retry.\n", cmd);
+        LOGERROR("iptables-restore failed '%s iptables-restore -c%s < %s': copying failed input file to '/tmp/euca_ipt_file_failed' for manual retry.\n", ipth->cmdprefix,
+                 (noflush ? " --noflush" : ""), ipth->ipt_file);
     }
     unlink(ipth->ipt_file);
     return (rc);
@@ -281,29 +351,52 @@ int ipt_system_restore(ipt_handler * ipth)
 int ipt_handler_deploy(ipt_handler * ipth)
 {
     int i, j, k;
+    int rc = 0;
     FILE *FH = NULL;
     if (!ipth || !ipth->init) {
         return (1);
     }
 
+    EUCA_PROBE(ipt__deploy__start);
     ipt_handler_update_refcounts(ipth);
 
+    for (i = 0; i < ipth->max_tables; i++) {
+        for (j = 0; j < ipth->tables[i].max_chains; j++) {
+            if (ipt_chain_is_live(&(ipth->tables[i].chains[j]))) {
+                // qsort! the rule index points at array positions, so it goes with it
+                qsort(ipth->tables[i].chains[j].rules, ipth->tables[i].chains[j].max_rules, sizeof(ipt_rule), ipt_ruleordercmp);
+                ipt_index_rebuild(&(ipth->tables[i].chains[j].ruleindex), &(ipth->tables[i].chains[j].ruleindex_size), ipth->tables[i].chains[j].rules[0].iptrule,
+                                  sizeof(ipt_rule), ipth->tables[i].chains[j].max_rules);
+            }
+        }
+    }
+
+    // with a record of what is deployed, only rewrite the chains that changed since
+    if (ipth->deployed) {
+        if (!ipt_handler_deploy_delta(ipth)) {
+            ipt_tables_free(ipth->deployed, ipth->max_deployed);
+            ipt_handler_snapshot(ipth, 1, &(ipth->deployed), &(ipth->max_deployed));
+            EUCA_PROBE1(ipt__deploy__done, 0);
+            return (0);
+        }
+        LOGWARN("incremental iptables deploy failed, falling back to a full restore\n");
+    }
+
     FH = fopen(ipth->ipt_file, "w");
     if (!FH) {
         LOGERROR("could not open file for write '%s': check permissions\n", ipth->ipt_file);
+        EUCA_PROBE1(ipt__deploy__done, 1);
         return (1);
     }
     for (i = 0; i < ipth->max_tables; i++) {
         fprintf(FH, "*%s\n", ipth->tables[i].name);
         for (j = 0; j < ipth->tables[i].max_chains; j++) {
-            if (!ipth->tables[i].chains[j].flushed && ipth->tables[i].chains[j].ref_count) {
+            if (ipt_chain_is_live(&(ipth->tables[i].chains[j]))) {
                 fprintf(FH, ":%s %s %s\n", ipth->tables[i].chains[j].name, ipth->tables[i].chains[j].policyname, ipth->tables[i].chains[j].counters);
             }
         }
         for (j = 0; j < ipth->tables[i].max_chains; j++) {
-            if (!ipth->tables[i].chains[j].flushed && ipth->tables[i].chains[j].ref_count) {
-                // qsort!
-                qsort(ipth->tables[i].chains[j].rules, ipth->tables[i].chains[j].max_rules, sizeof(ipt_rule), ipt_ruleordercmp);
+            if (ipt_chain_is_live(&(ipth->tables[i].chains[j]))) {
                 for (k = 0; k < ipth->tables[i].chains[j].max_rules; k++) {
                     if (!ipth->tables[i].chains[j].rules[k].flushed) {
                         fprintf(FH, "%s %s\n", ipth->tables[i].chains[j].rules[k].counterstr, ipth->tables[i].chains[j].rules[k].iptrule);
@@ -315,7 +408,332 @@ int ipt_handler_deploy(ipt_handler * ipth)
     }
     fclose(FH);
 
-    return (ipt_system_restore(ipth));
+    ipt_tables_free(ipth->deployed, ipth->max_deployed);
+    ipth->deployed = NULL;
+    ipth->max_deployed = 0;
+    if ((rc = ipt_system_restore(ipth)) == 0) {
+        ipt_handler_snapshot(ipth, 1, &(ipth->deployed), &(ipth->max_deployed));
+    }
+    EUCA_PROBE1(ipt__deploy__done, rc);
+    return (rc);
+}
+
+//!
+//! Frees an array of tables along with their chains and rules
+//!
+//! @param[in] tables the array of tables (may be NULL)
+//! @param[in] max_tables number of tables in the array
+//!
+static void ipt_tables_free(ipt_table * tables, int max_tables)
+{
+    int i, j;
+
+    if (!tables) {
+        return;
+    }
+
+    for (i = 0; i < max_tables; i++) {
+        for (j = 0; j < tables[i].max_chains; j++) {
+            EUCA_FREE(tables[i].chains[j].rules);
+            EUCA_FREE(tables[i].chains[j].ruleindex);
+        }
+        EUCA_FREE(tables[i].chains);
+        EUCA_FREE(tables[i].chainindex);
+    }
+    EUCA_FREE(tables);
+}
+
+//!
+//! Looks up a table by name in an array of tables
+//!
+//! @param[in] tables the array of tables (may be NULL)
+//! @param[in] max_tables number of tables in the array
+//! @param[in] findtable the name of the table to look for
+//!
+//! @return a pointer to the table or NULL if not found
+//!
+static ipt_table *ipt_tables_find_table(ipt_table * tables, int max_tables, char *findtable)
+{
+    int i;
+
+    for (i = 0; tables && (i < max_tables); i++) {
+        if (!strcmp(tables[i].name, findtable)) {
+            return (&(tables[i]));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Looks up a chain by name in a table
+//!
+//! @param[in] table the table to look into (may be NULL)
+//! @param[in] findchain the name of the chain to look for
+//!
+//! @return a pointer to the chain or NULL if not found
+//!
+static ipt_chain *ipt_tables_find_chain(ipt_table * table, char *findchain)
+{
+    int i;
+
+    for (i = 0; table && (i < table->max_chains); i++) {
+        if (!strcmp(table->chains[i].name, findchain)) {
+            return (&(table->chains[i]));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Tells whether a chain is part of the ruleset that gets deployed
+//!
+//! @param[in] chain the chain to check
+//!
+//! @return 1 if the chain is neither flushed nor unreferenced, 0 otherwise
+//!
+static int ipt_chain_is_live(ipt_chain * chain)
+{
+    return ((!chain->flushed && chain->ref_count) ? 1 : 0);
+}
+
+//!
+//! Copies the chains of the IP table handler along with their rules that are not flushed
+//!
+//! @param[in]  ipth pointer to the IP table handler structure
+//! @param[in]  live_only set to 1 to only copy the chains that get deployed
+//! @param[out] outtables set to the newly allocated array of tables
+//! @param[out] outmax set to the number of tables in the array
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int ipt_handler_snapshot(ipt_handler * ipth, int live_only, ipt_table ** outtables, int *outmax)
+{
+    int i, j, k;
+    ipt_table *tables = NULL, *table = NULL;
+    ipt_chain *chain = NULL, *newchain = NULL;
+
+    *outtables = NULL;
+    *outmax = 0;
+    if (!ipth->max_tables) {
+        return (0);
+    }
+
+    if ((tables = EUCA_ZALLOC(ipth->max_tables, sizeof(ipt_table))) == NULL) {
+        LOGERROR("out of memory!\n");
+        return (1);
+    }
+
+    for (i = 0; i < ipth->max_tables; i++) {
+        table = &(ipth->tables[i]);
+        snprintf(tables[i].name, 64, "%s", table->name);
+        if (table->max_chains && (tables[i].chains = EUCA_ZALLOC(table->max_chains, sizeof(ipt_chain))) == NULL) {
+            LOGERROR("out of memory!\n");
+            ipt_tables_free(tables, ipth->max_tables);
+            return (1);
+        }
+
+        for (j = 0; j < table->max_chains; j++) {
+            chain = &(table->chains[j]);
+            if (live_only && !ipt_chain_is_live(chain)) {
+                continue;
+            }
+
+            newchain = &(tables[i].chains[tables[i].max_chains]);
+            memcpy(newchain, chain, sizeof(ipt_chain));
+            newchain->rules = NULL;
+            newchain->max_rules = 0;
+            newchain->rules_size = chain->max_rules;
+            newchain->ruleindex = NULL;
+            newchain->ruleindex_size = 0;
+            newchain->flushed = 0;
+            tables[i].max_chains++;
+
+            if (chain->max_rules && (newchain->rules = EUCA_ALLOC(chain->max_rules, sizeof(ipt_rule))) == NULL) {
+                LOGERROR("out of memory!\n");
+                ipt_tables_free(tables, ipth->max_tables);
+                return (1);
+            }
+            for (k = 0; k < chain->max_rules; k++) {
+                if (!chain->rules[k].flushed) {
+                    memcpy(&(newchain->rules[newchain->max_rules]), &(chain->rules[k]), sizeof(ipt_rule));
+                    newchain->max_rules++;
+                }
+            }
+        }
+    }
+
+    *outtables = tables;
+    *outmax = ipth->max_tables;
+    return (0);
+}
+
+//!
+//! Rebuilds the record of what is deployed from the freshly read system rules. The rule text
+//! of a chain is kept from the previous record when the system still has the same number of
+//! rules in it, as iptables-save may spell a rule differently than it was written. A chain
+//! whose rule count changed behind our back is marked so that it gets rewritten.
+//!
+//! @param[in] ipth pointer to the IP table handler structure, just repopulated
+//! @param[in] deployed the previous record (consumed by this call, may be NULL)
+//! @param[in] max_deployed number of tables in the previous record
+//!
+static void ipt_handler_reconcile_deployed(ipt_handler * ipth, ipt_table * deployed, int max_deployed)
+{
+    int i, j;
+    ipt_rule *rules = NULL;
+    ipt_chain *chain = NULL, *oldchain = NULL;
+
+    ipt_tables_free(ipth->deployed, ipth->max_deployed);
+    if (ipt_handler_snapshot(ipth, 0, &(ipth->deployed), &(ipth->max_deployed))) {
+        ipth->deployed = NULL;
+        ipth->max_deployed = 0;
+    }
+
+    for (i = 0; deployed && (i < ipth->max_deployed); i++) {
+        for (j = 0; j < ipth->deployed[i].max_chains; j++) {
+            chain = &(ipth->deployed[i].chains[j]);
+            oldchain = ipt_tables_find_chain(ipt_tables_find_table(deployed, max_deployed, ipth->deployed[i].name), chain->name);
+            if (!oldchain) {
+                continue;
+            }
+
+            if (oldchain->max_rules == chain->max_rules) {
+                rules = chain->rules;
+                chain->rules = oldchain->rules;
+                oldchain->rules = rules;
+            } else {
+                chain->flushed = 1;
+            }
+        }
+    }
+    ipt_tables_free(deployed, max_deployed);
+}
+
+//!
+//! Compares a chain of the IP table handler with its deployed copy
+//!
+//! @param[in] chain the chain as it is about to be deployed, with its rules sorted
+//! @param[in] deployed the deployed copy of the chain (may be NULL)
+//!
+//! @return 1 if the chain has to be rewritten, 0 if it is already deployed as is
+//!
+static int ipt_chain_changed(ipt_chain * chain, ipt_chain * deployed)
+{
+    int k, l;
+
+    if (!deployed || deployed->flushed || strcmp(chain->policyname, deployed->policyname)) {
+        return (1);
+    }
+
+    for (k = 0, l = 0; k < chain->max_rules; k++) {
+        if (chain->rules[k].flushed) {
+            continue;
+        }
+        if ((l >= deployed->max_rules) || strcmp(chain->rules[k].iptrule, deployed->rules[l].iptrule)) {
+            return (1);
+        }
+        l++;
+    }
+    return ((l == deployed->max_rules) ? 0 : 1);
+}
+
+//!
+//! Writes and applies only the chains that differ from the deployed copy. Changed chains are
+//! declared, flushed and filled, chains that are no longer deployed are flushed and deleted,
+//! and nothing is run when no chain differs.
+//!
+//! @param[in] ipth pointer to the IP table handler structure, with the live chains sorted
+//!
+//! @return 0 on success or when there is nothing to do, 1 on failure
+//!
+static int ipt_handler_deploy_delta(ipt_handler * ipth)
+{
+    int i, j, k;
+    int changes = 0, tablechanges = 0;
+    int *changed = NULL;
+    FILE *FH = NULL;
+    ipt_table *table = NULL, *deployed = NULL;
+    ipt_chain *chain = NULL, *oldchain = NULL;
+
+    FH = fopen(ipth->ipt_file, "w");
+    if (!FH) {
+        LOGERROR("could not open file for write '%s': check permissions\n", ipth->ipt_file);
+        return (1);
+    }
+
+    for (i = 0; i < ipth->max_tables; i++) {
+        table = &(ipth->tables[i]);
+        deployed = ipt_tables_find_table(ipth->deployed, ipth->max_deployed, table->name);
+
+        if (table->max_chains && (changed = EUCA_ZALLOC(table->max_chains, sizeof(int))) == NULL) {
+            LOGERROR("out of memory!\n");
+            fclose(FH);
+            unlink(ipth->ipt_file);
+            return (1);
+        }
+
+        tablechanges = 0;
+        for (j = 0; j < table->max_chains; j++) {
+            if (ipt_chain_is_live(&(table->chains[j])) && ipt_chain_changed(&(table->chains[j]), ipt_tables_find_chain(deployed, table->chains[j].name))) {
+                changed[j] = 1;
+                tablechanges++;
+            }
+        }
+        for (j = 0; deployed && (j < deployed->max_chains); j++) {
+            chain = ipt_table_find_chain(ipth, table->name, deployed->chains[j].name);
+            if (!chain || !ipt_chain_is_live(chain)) {
+                tablechanges++;
+            }
+        }
+
+        if (tablechanges) {
+            fprintf(FH, "*%s\n", table->name);
+            for (j = 0; j < table->max_chains; j++) {
+                chain = &(table->chains[j]);
+                if (changed[j]) {
+                    fprintf(FH, ":%s %s %s\n", chain->name, chain->policyname, chain->counters);
+                    if (ipt_tables_find_chain(deployed, chain->name)) {
+                        // ':' only flushes user chains with --noflush
+                        fprintf(FH, "-F %s\n", chain->name);
+                    }
+                }
+            }
+            for (j = 0; deployed && (j < deployed->max_chains); j++) {
+                chain = ipt_table_find_chain(ipth, table->name, deployed->chains[j].name);
+                if (!chain || !ipt_chain_is_live(chain)) {
+                    fprintf(FH, "-F %s\n", deployed->chains[j].name);
+                }
+            }
+            for (j = 0; j < table->max_chains; j++) {
+                chain = &(table->chains[j]);
+                for (k = 0; changed[j] && (k < chain->max_rules); k++) {
+                    if (!chain->rules[k].flushed) {
+                        fprintf(FH, "%s %s\n", chain->rules[k].counterstr, chain->rules[k].iptrule);
+                    }
+                }
+            }
+            for (j = 0; deployed && (j < deployed->max_chains); j++) {
+                oldchain = &(deployed->chains[j]);
+                chain = ipt_table_find_chain(ipth, table->name, oldchain->name);
+                if ((!chain || !ipt_chain_is_live(chain)) && !strcmp(oldchain->policyname, "-")) {
+                    fprintf(FH, "-X %s\n", oldchain->name);
+                }
+            }
+            fprintf(FH, "COMMIT\n");
+            changes += tablechanges;
+        }
+        EUCA_FREE(changed);
+    }
+    fclose(FH);
+
+    if (!changes) {
+        LOGDEBUG("iptables rules unchanged since last deploy, nothing to restore\n");
+        unlink(ipth->ipt_file);
+        return (0);
+    }
+
+    LOGDEBUG("deploying %d changed iptables chain(s)\n", changes);
+    return (ipt_system_restore_noflush(ipth));
 }
 
 //!
@@ -377,26 +795,37 @@ int ipt_handler_repopulate(ipt_handler * ipth)
     char policyname[64] = "";
     char counters[64] = "";
     char counterstr[256] = "";
+    ipt_table *deployed = NULL;
+    int max_deployed = 0;
     //  long long int countersa, countersb;
 
     if (!ipth || !ipth->init) {
         return (1);
     }
 
+    // hold on to what was deployed last, the rules read back below are compared to it
+    deployed = ipth->deployed;
+    max_deployed = ipth->max_deployed;
+    ipth->deployed = NULL;
+    ipth->max_deployed = 0;
+
     rc = ipt_handler_free(ipth);
     if (rc) {
+        ipt_tables_free(deployed, max_deployed);
         return (1);
     }
 
     rc = ipt_system_save(ipth);
     if (rc) {
         LOGERROR("could not save current IPT rules to file, exiting re-populate\n");
+        ipt_tables_free(deployed, max_deployed);
         return (1);
     }
 
     FH = fopen(ipth->ipt_file, "r");
     if (!FH) {
         LOGERROR("could not open file for read '%s': check permissions\n", ipth->ipt_file);
+        ipt_tables_free(deployed, max_deployed);
         return (1);
     }
 
@@ -439,9 +868,112 @@ int ipt_handler_repopulate(ipt_handler * ipth)
     }
     fclose(FH);
 
+    ipt_handler_reconcile_deployed(ipth, deployed, max_deployed);
     return (0);
 }
 
+//!
+//! Computes the home bucket of a key in a chain or rule index
+//!
+//! @param[in] key the chain name or rule to hash
+//! @param[in] index_size number of buckets in the index (power of 2)
+//!
+//! @return the bucket number
+//!
+static int ipt_index_bucket(const char *key, int index_size)
+{
+    unsigned int h = 2166136261U;      // FNV-1a
+
+    for (; *key != '\0'; key++) {
+        h ^= (unsigned char)*key;
+        h *= 16777619U;
+    }
+    return ((int)(h & (index_size - 1)));
+}
+
+//!
+//! Looks up an entry in a chain or rule index. The key of entry i is the string found at
+//! (keys + (i * stride)), which is the name of a chain or the iptrule of a rule.
+//!
+//! @param[in] index the index buckets (may be NULL)
+//! @param[in] index_size number of buckets in the index
+//! @param[in] keys pointer to the key of the first entry
+//! @param[in] stride size of one entry
+//! @param[in] key the key to look for
+//!
+//! @return the entry number or -1 if not found
+//!
+static int ipt_index_find(int *index, int index_size, const char *keys, size_t stride, const char *key)
+{
+    int i;
+
+    if (!index) {
+        return (-1);
+    }
+
+    for (i = ipt_index_bucket(key, index_size); index[i] != 0; i = ((i + 1) & (index_size - 1))) {
+        if (!strcmp(keys + ((index[i] - 1) * stride), key)) {
+            return (index[i] - 1);
+        }
+    }
+    return (-1);
+}
+
+//!
+//! Adds an entry to a chain or rule index (open addressing, linear probing). The caller
+//! makes sure the index is at most half full.
+//!
+//! @param[in] index the index buckets
+//! @param[in] index_size number of buckets in the index
+//! @param[in] keys pointer to the key of the first entry
+//! @param[in] stride size of one entry
+//! @param[in] entry the entry number to add
+//!
+static void ipt_index_insert(int *index, int index_size, const char *keys, size_t stride, int entry)
+{
+    int i;
+
+    for (i = ipt_index_bucket(keys + (entry * stride), index_size); index[i] != 0; i = ((i + 1) & (index_size - 1))) ;
+    index[i] = entry + 1;
+}
+
+//!
+//! Rebuilds a chain or rule index over all the entries of its array, doubling the number
+//! of buckets until the index is at most half full. This is called whenever the array
+//! is reordered or has outgrown the index.
+//!
+//! @param[in,out] pindex pointer to the index buckets, reallocated as needed
+//! @param[in,out] pindex_size pointer to the number of buckets in the index
+//! @param[in]     keys pointer to the key of the first entry
+//! @param[in]     stride size of one entry
+//! @param[in]     max_entries number of entries in the array
+//!
+static void ipt_index_rebuild(int **pindex, int *pindex_size, const char *keys, size_t stride, int max_entries)
+{
+    int i;
+    int size = ((*pindex_size) ? (*pindex_size) : IPT_MIN_INDEX_SIZE);
+
+    while ((max_entries * 2) > size) {
+        size *= 2;
+    }
+
+    if (size != (*pindex_size)) {
+        EUCA_FREE(*pindex);
+        *pindex_size = 0;
+        if ((*pindex = EUCA_ZALLOC(size, sizeof(int))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        *pindex_size = size;
+    } else {
+        bzero(*pindex, size * sizeof(int));
+    }
+
+    for (i = 0; i < max_entries; i++) {
+        ipt_index_insert(*pindex, *pindex_size, keys, stride, i);
+    }
+}
+
 //!
 //! Function description.
 //!
@@ -514,10 +1046,13 @@ int ipt_table_add_chain(ipt_handler * ipth, char *tablename, char *chainname, ch
 
     chain = ipt_table_find_chain(ipth, tablename, chainname);
     if (!chain) {
-        table->chains = realloc(table->chains, sizeof(ipt_chain) * (table->max_chains + 1));
-        if (!table->chains) {
-            LOGFATAL("out of memory!\n");
-            exit(1);
+        if (table->max_chains >= table->chains_size) {
+            table->chains_size = ((table->chains_size) ? (table->chains_size * 2) : IPT_MIN_CHAINS_SIZE);
+            table->chains = realloc(table->chains, sizeof(ipt_chain) * table->chains_size);
+            if (!table->chains) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
         }
         bzero(&(table->chains[table->max_chains]), sizeof(ipt_chain));
         snprintf(table->chains[table->max_chains].name, 64, "%s", chainname);
@@ -531,6 +1066,12 @@ int ipt_table_add_chain(ipt_handler * ipth, char *tablename, char *chainname, ch
         }
         chain = &(table->chains[table->max_chains]);
         table->max_chains++;
+
+        if ((table->max_chains * 2) > table->chainindex_size) {
+            ipt_index_rebuild(&(table->chainindex), &(table->chainindex_size), table->chains[0].name, sizeof(ipt_chain), table->max_chains);
+        } else {
+            ipt_index_insert(table->chainindex, table->chainindex_size, table->chains[0].name, sizeof(ipt_chain), (table->max_chains - 1));
+        }
     }
     chain->flushed = 0;
 
@@ -627,16 +1168,25 @@ int ipt_chain_insert_rule(ipt_handler * ipth, char *tablename, char *chainname,
 
     rule = ipt_chain_find_rule(ipth, tablename, chainname, newrule);
     if (!rule) {
-        chain->rules = realloc(chain->rules, sizeof(ipt_rule) * (chain->max_rules + 1));
-        if (!chain->rules) {
-            LOGFATAL("out of memory!\n");
-            exit(1);
+        if (chain->max_rules >= chain->rules_size) {
+            chain->rules_size = ((chain->rules_size) ? (chain->rules_size * 2) : IPT_MIN_RULES_SIZE);
+            chain->rules = realloc(chain->rules, sizeof(ipt_rule) * chain->rules_size);
+            if (!chain->rules) {
+                LOGFATAL("out of memory!\n");
+                exit(1);
+            }
         }
         rule = &(chain->rules[chain->max_rules]);
         bzero(rule, sizeof(ipt_rule));
         snprintf(rule->iptrule, 1024, "%s", newrule);
         snprintf(rule->counterstr, 256, "[0:0]");
         chain->max_rules++;
+
+        if ((chain->max_rules * 2) > chain->ruleindex_size) {
+            ipt_index_rebuild(&(chain->ruleindex), &(chain->ruleindex_size), chain->rules[0].iptrule, sizeof(ipt_rule), chain->max_rules);
+        } else {
+            ipt_index_insert(chain->ruleindex, chain->ruleindex_size, chain->rules[0].iptrule, sizeof(ipt_rule), (chain->max_rules - 1));
+        }
     }
     if (counterstr && strlen(counterstr)) {
         snprintf(rule->counterstr, 256, "%s", counterstr);
@@ -757,7 +1307,7 @@ ipt_table *ipt_handler_find_table(ipt_handler * ipth, char *findtable)
 //!
 ipt_chain *ipt_table_find_chain(ipt_handler * ipth, char *tablename, char *findchain)
 {
-    int i, found = 0, chainidx = 0;
+    int chainidx = 0;
     ipt_table *table = NULL;
 
     if (!ipth || !tablename || !findchain || !ipth->init) {
@@ -769,14 +1319,7 @@ ipt_chain *ipt_table_find_chain(ipt_handler * ipth, char *tablename, char *findc
         return (NULL);
     }
 
-    found = 0;
-    for (i = 0; i < table->max_chains && !found; i++) {
-        chainidx = i;
-        if (!strcmp(table->chains[i].name, findchain))
-            found++;
-    }
-
-    if (!found) {
+    if ((chainidx = ipt_index_find(table->chainindex, table->chainindex_size, table->chains[0].name, sizeof(ipt_chain), findchain)) < 0) {
         return (NULL);
     }
 
@@ -803,7 +1346,7 @@ ipt_chain *ipt_table_find_chain(ipt_handler * ipth, char *tablename, char *findc
 //!
 ipt_rule *ipt_chain_find_rule(ipt_handler * ipth, char *tablename, char *chainname, char *findrule)
 {
-    int i, found = 0, ruleidx = 0;
+    int ruleidx = 0;
     ipt_chain *chain;
 
     if (!ipth || !tablename || !chainname || !findrule || !ipth->init) {
@@ -815,12 +1358,7 @@ ipt_rule *ipt_chain_find_rule(ipt_handler * ipth, char *tablename, char *chainna
         return (NULL);
     }
 
-    for (i = 0; i < chain->max_rules && !found; i++) {
-        ruleidx = i;
-        if (!strcmp(chain->rules[i].iptrule, findrule))
-            found++;
-    }
-    if (!found) {
+    if ((ruleidx = ipt_index_find(chain->ruleindex, chain->ruleindex_size, chain->rules[0].iptrule, sizeof(ipt_rule), findrule)) < 0) {
         return (NULL);
     }
     return (&(chain->rules[ruleidx]));
@@ -987,10 +1525,13 @@ int ipt_handler_free(ipt_handler * ipth)
     for (i = 0; i < ipth->max_tables; i++) {
         for (j = 0; j < ipth->tables[i].max_chains; j++) {
             EUCA_FREE(ipth->tables[i].chains[j].rules);
+            EUCA_FREE(ipth->tables[i].chains[j].ruleindex);
         }
         EUCA_FREE(ipth->tables[i].chains);
+        EUCA_FREE(ipth->tables[i].chainindex);
     }
     EUCA_FREE(ipth->tables);
+    ipt_tables_free(ipth->deployed, ipth->max_deployed);
     unlink(ipth->ipt_file);
 
     return (ipt_handler_init(ipth, saved_cmdprefix));
@@ -1171,7 +1712,7 @@ int ips_system_restore(ips_handler * ipsh)
 //!
 int ips_handler_repopulate(ips_handler * ipsh)
 {
-    int rc = 0, nm = 0;
+    int i = 0, rc = 0, nm = 0;
     FILE *FH = NULL;
     char buf[1024] = "";
     char *strptr = NULL;
@@ -1235,6 +1776,11 @@ int ips_handler_repopulate(ips_handler * ipsh)
     }
     fclose(FH);
 
+    for (i = 0; i < ipsh->max_sets; i++) {
+        ipsh->sets[i].deployed = 1;
+        ipsh->sets[i].deployed_hash = ips_set_hash(&(ipsh->sets[i]));
+    }
+
     return (0);
 }
 
@@ -1285,15 +1831,143 @@ int cidrsplit(char *ipname, char **ippart, int *nmpart)
 //! @note
 //!
 int ips_handler_deploy(ips_handler * ipsh, int dodelete)
+{
+    int rc = 0;
+
+    if (!ipsh || !ipsh->init) {
+        return (1);
+    }
+
+    if ((rc = ips_handler_deploy_swap(ipsh, dodelete)) != 0) {
+        LOGWARN("could not swap in the changed ipsets, falling back to rebuilding all of them in place\n");
+        rc = ips_handler_deploy_full(ipsh, dodelete);
+    }
+
+    if (!rc) {
+        ips_handler_mark_deployed(ipsh, dodelete);
+    }
+    return (rc);
+}
+
+//!
+//! Computes a hash of the members of a set that does not depend on the order they were added in
+//!
+//! @param[in] set the set to hash
+//!
+//! @return the content hash
+//!
+static unsigned long long ips_set_hash(ips_set * set)
+{
+    int i;
+    unsigned long long x, h = 0;
+
+    for (i = 0; i <= set->max_member_ips; i++) {
+        // the member count goes in last so that the sum cannot be hit by a smaller set
+        x = ((i < set->max_member_ips) ? ((((unsigned long long)set->member_ips[i]) << 6) | (set->member_nms[i] & 0x3f)) : (~0ULL - set->max_member_ips));
+
+        // splitmix64 finalizer
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        h += (x ^ (x >> 31));
+    }
+    return (h);
+}
+
+//!
+//! Writes the 'add' lines for every member of a set, under the given set name
+//!
+//! @param[in] FH the ipset restore file
+//! @param[in] set the set to write the members of
+//! @param[in] name the name of the set the members go into
+//!
+static void ips_set_write_members(FILE * FH, ips_set * set, char *name)
+{
+    int j;
+    char *strptra = NULL;
+
+    for (j = 0; j < set->max_member_ips; j++) {
+        strptra = hex2dot(set->member_ips[j]);
+        LOGDEBUG("adding ip/nm %s/%d to ipset %s\n", strptra, set->member_nms[j], name);
+        fprintf(FH, "add %s %s/%d\n", name, strptra, set->member_nms[j]);
+        EUCA_FREE(strptra);
+    }
+}
+
+//!
+//! Deploys the sets that changed in a single 'ipset restore' batch. A changed set that already
+//! exists is built under a temporary name and swapped in, so that the rules matching on it never
+//! see it empty or half filled. Sets whose content hash matches what is on the system are left
+//! alone, and nothing is run at all if no set changed.
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] dodelete set to 1 to also destroy the sets that are no longer referenced
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int ips_handler_deploy_swap(ips_handler * ipsh, int dodelete)
 {
     int i = 0;
-    int j = 0;
+    int changes = 0;
+    char tmpname[64] = "";
     FILE *FH = NULL;
-    char *strptra = NULL;
+    ips_set *set = NULL;
 
-    if (!ipsh || !ipsh->init) {
+    FH = fopen(ipsh->ips_file, "w");
+    if (!FH) {
+        LOGERROR("could not open file for write '%s': check permissions\n", ipsh->ips_file);
         return (1);
     }
+    for (i = 0; i < ipsh->max_sets; i++) {
+        set = &(ipsh->sets[i]);
+        if (set->ref_count) {
+            if (set->deployed && (set->deployed_hash == ips_set_hash(set))) {
+                continue;
+            }
+
+            if (set->deployed) {
+                snprintf(tmpname, 32, "%s%d", IPS_SWAP_PREFIX, i);
+                fprintf(FH, "create %s %s\n", tmpname, IPS_SET_TYPE);
+                fprintf(FH, "flush %s\n", tmpname);
+                ips_set_write_members(FH, set, tmpname);
+                fprintf(FH, "swap %s %s\n", tmpname, set->name);
+                fprintf(FH, "destroy %s\n", tmpname);
+            } else {
+                fprintf(FH, "create %s %s\n", set->name, IPS_SET_TYPE);
+                fprintf(FH, "flush %s\n", set->name);
+                ips_set_write_members(FH, set, set->name);
+            }
+            changes++;
+        } else if ((set->ref_count == 0) && dodelete && set->deployed) {
+            fprintf(FH, "flush %s\n", set->name);
+            fprintf(FH, "destroy %s\n", set->name);
+            changes++;
+        }
+    }
+    fclose(FH);
+
+    if (!changes) {
+        LOGDEBUG("ipsets unchanged since last deploy, nothing to restore\n");
+        unlink(ipsh->ips_file);
+        return (0);
+    }
+
+    LOGDEBUG("deploying %d changed ipset(s)\n", changes);
+    return (ips_system_restore(ipsh) ? 1 : 0);
+}
+
+//!
+//! Rebuilds every referenced set in place, regardless of what is on the system
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] dodelete set to 1 to also destroy the sets that are no longer referenced
+//!
+//! @return 0 on success or the ipset exit code on failure
+//!
+static int ips_handler_deploy_full(ips_handler * ipsh, int dodelete)
+{
+    int i = 0;
+    FILE *FH = NULL;
 
     FH = fopen(ipsh->ips_file, "w");
     if (!FH) {
@@ -1302,16 +1976,11 @@ int ips_handler_deploy(ips_handler * ipsh, int dodelete)
     }
     for (i = 0; i < ipsh->max_sets; i++) {
         if (ipsh->sets[i].ref_count) {
-            fprintf(FH, "create %s hash:net family inet hashsize 2048 maxelem 65536\n", ipsh->sets[i].name);
+            fprintf(FH, "create %s %s\n", ipsh->sets[i].name, IPS_SET_TYPE);
             fprintf(FH, "flush %s\n", ipsh->sets[i].name);
-            for (j = 0; j < ipsh->sets[i].max_member_ips; j++) {
-                strptra = hex2dot(ipsh->sets[i].member_ips[j]);
-                LOGDEBUG("adding ip/nm %s/%d to ipset %s\n", strptra, ipsh->sets[i].member_nms[j], ipsh->sets[i].name);
-                fprintf(FH, "add %s %s/%d\n", ipsh->sets[i].name, strptra, ipsh->sets[i].member_nms[j]);
-                EUCA_FREE(strptra);
-            }
+            ips_set_write_members(FH, &(ipsh->sets[i]), ipsh->sets[i].name);
         } else if ((ipsh->sets[i].ref_count == 0) && dodelete) {
-            fprintf(FH, "create %s hash:net family inet hashsize 2048 maxelem 65536\n", ipsh->sets[i].name);
+            fprintf(FH, "create %s %s\n", ipsh->sets[i].name, IPS_SET_TYPE);
             fprintf(FH, "flush %s\n", ipsh->sets[i].name);
             fprintf(FH, "destroy %s\n", ipsh->sets[i].name);
         }
@@ -1321,6 +1990,26 @@ int ips_handler_deploy(ips_handler * ipsh, int dodelete)
     return (ips_system_restore(ipsh));
 }
 
+//!
+//! Records the sets as they now are on the system after a successful deploy
+//!
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] dodelete set to 1 if the deploy destroyed the sets that are no longer referenced
+//!
+static void ips_handler_mark_deployed(ips_handler * ipsh, int dodelete)
+{
+    int i = 0;
+
+    for (i = 0; i < ipsh->max_sets; i++) {
+        if (ipsh->sets[i].ref_count) {
+            ipsh->sets[i].deployed = 1;
+            ipsh->sets[i].deployed_hash = ips_set_hash(&(ipsh->sets[i]));
+        } else if (dodelete) {
+            ipsh->sets[i].deployed = 0;
+        }
+    }
+}
+
 //!
 //! Function description.
 //!
@@ -1882,6 +2571,11 @@ int ebt_handler_deploy(ebt_handler * ebth)
 
     ebt_handler_update_refcounts(ebth);
 
+    // one ebtables-restore for the whole ruleset, rather than one ebtables run per rule
+    if (!ebt_handler_deploy_batch(ebth)) {
+        return (0);
+    }
+
     snprintf(cmd, EUCA_MAX_PATH, "%s ebtables --atomic-file %s -t filter --atomic-init", ebth->cmdprefix, ebth->ebt_filter_file);
     rc = system(cmd);
     rc = rc >> 8;
@@ -1940,6 +2634,90 @@ int ebt_handler_deploy(ebt_handler * ebth)
     return (ebt_system_restore(ebth));
 }
 
+//!
+//! Writes the whole ruleset to a single ebtables-restore batch and commits it, a table at a
+//! time, in one run. Like the atomic file path, both tables are rebuilt from their default
+//! built-in chains.
+//!
+//! @param[in] ebth pointer to the EB table handler structure, with the refcounts up to date
+//!
+//! @return 0 on success or 1 if ebtables-restore failed or is not available, in which case
+//!         the caller falls back to the atomic files
+//!
+static int ebt_handler_deploy_batch(ebt_handler * ebth)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int t = 0;
+    int rc = 0;
+    char cmd[EUCA_MAX_PATH] = "";
+    FILE *FH = NULL;
+    ebt_table *table = NULL;
+    ebt_chain *chain = NULL;
+    static const char *tables[] = { "filter", "nat", NULL };
+    static const char *builtins[] = { "INPUT FORWARD OUTPUT", "PREROUTING OUTPUT POSTROUTING" };
+    char builtin[64] = "", *tok = NULL, *saveptr = NULL;
+
+    // the ascii listing file is only scratch space while deploying
+    FH = fopen(ebth->ebt_asc_file, "w");
+    if (!FH) {
+        LOGERROR("could not open file for write '%s': check permissions\n", ebth->ebt_asc_file);
+        return (1);
+    }
+
+    for (t = 0; tables[t]; t++) {
+        fprintf(FH, "*%s\n", tables[t]);
+        snprintf(builtin, 64, "%s", builtins[t]);
+        for (tok = strtok_r(builtin, " ", &saveptr); tok; tok = strtok_r(NULL, " ", &saveptr)) {
+            fprintf(FH, ":%s ACCEPT\n", tok);
+        }
+
+        for (i = 0, table = NULL; (i < ebth->max_tables) && !table; i++) {
+            if (!strcmp(ebth->tables[i].name, tables[t])) {
+                table = &(ebth->tables[i]);
+            }
+        }
+        if (!table) {
+            continue;
+        }
+
+        for (j = 0; j < table->max_chains; j++) {
+            chain = &(table->chains[j]);
+            if (strcmp(chain->name, "EMPTY") && chain->ref_count) {
+                if (strcmp(chain->name, "INPUT") && strcmp(chain->name, "OUTPUT") && strcmp(chain->name, "FORWARD")
+                    && strcmp(chain->name, "PREROUTING") && strcmp(chain->name, "POSTROUTING")) {
+                    fprintf(FH, ":%s ACCEPT\n", chain->name);
+                }
+            }
+        }
+        for (j = 0; j < table->max_chains; j++) {
+            chain = &(table->chains[j]);
+            if (strcmp(chain->name, "EMPTY") && chain->ref_count) {
+                for (k = 0; k < chain->max_rules; k++) {
+                    fprintf(FH, "-A %s %s\n", chain->name, chain->rules[k].ebtrule);
+                }
+            }
+        }
+    }
+    fclose(FH);
+
+    snprintf(cmd, EUCA_MAX_PATH, "%s ebtables-restore < %s >/dev/null 2>&1", ebth->cmdprefix, ebth->ebt_asc_file);
+    rc = system(cmd);
+    rc = rc >> 8;
+    LOGTRACE("executed command (exit=%d): %s\n", rc, cmd);
+    if (rc) {
+        LOGDEBUG("ebtables-restore failed or is not available (exit=%d), falling back to atomic files\n", rc);
+        unlink(ebth->ebt_asc_file);
+        return (1);
+    }
+
+    unlink(ebth->ebt_filter_file);
+    unlink(ebth->ebt_nat_file);
+    unlink(ebth->ebt_asc_file);
+    return (0);
+}
+
 //!
 //! Function description.
 //!
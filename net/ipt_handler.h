@@ -115,6 +115,9 @@ typedef struct ipt_chain_t {
     char name[64], policyname[64], counters[64];
     ipt_rule *rules;
     int max_rules;
+    int rules_size;                    //!< number of allocated entries in rules
+    int *ruleindex;                    //!< open addressing hash of the rules by iptrule, entries are (index + 1) and 0 when free
+    int ruleindex_size;
     int ruleorder;
     int ref_count;
     int flushed;
@@ -124,11 +127,16 @@ typedef struct ipt_table_t {
     char name[64];
     ipt_chain *chains;
     int max_chains;
+    int chains_size;                   //!< number of allocated entries in chains
+    int *chainindex;                   //!< open addressing hash of the chains by name, entries are (index + 1) and 0 when free
+    int chainindex_size;
 } ipt_table;
 
 typedef struct ipt_handler_t {
     ipt_table *tables;
     int max_tables;
+    ipt_table *deployed;               //!< copy of the live chains as last deployed, to only rewrite what changed
+    int max_deployed;
     int init;
     char ipt_file[EUCA_MAX_PATH];
     char cmdprefix[EUCA_MAX_PATH];
@@ -140,6 +148,8 @@ typedef struct ips_set_t {
     int *member_nms;
     int max_member_ips;
     int ref_count;
+    int deployed;                      //!< set to 1 when the set exists on the system
+    unsigned long long deployed_hash;  //!< content hash of the members as they are on the system, to skip unchanged sets
 } ips_set;
 
 typedef struct ips_handler_t {
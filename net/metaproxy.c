@@ -0,0 +1,848 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file net/metaproxy.c
+//! The VPC metadata proxy (eucanetd-metaproxy). A single process listens in the network
+//! namespace of every VPC, on sockets it creates there with setns(), and forwards what the
+//! instances ask to the metadata service, telling it which instance is asking. It replaces
+//! the nginx process eucanetd used to run in each VPC namespace.
+//!
+//! The VPCs to listen in are the ones eucanetd lists in METAPROXY_VPCS_FILE. The proxy picks
+//! up changes to the list within a second and notices a VPC namespace that was created again
+//! within METAPROXY_CHECK_SEC seconds.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE                    // for setns() and accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <euca_string.h>
+#include <log.h>
+
+#include "metaproxy.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define METAPROXY_CHECK_SEC                      5  //!< how often the namespaces are checked for having been created again
+#define METAPROXY_MAX_CONNECTIONS                1024   //!< connections served at once, more are closed right away
+#define METAPROXY_HEADER_MAX                     16384  //!< the largest request header accepted
+#define METAPROXY_IO_TIMEOUT_SEC                 30 //!< how long a connection may stall
+#define METAPROXY_BACKLOG                        128
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A VPC namespace the proxy listens in
+typedef struct metaproxy_vpc_t {
+    char name[16];                     //!< the VPC, which is also the name of its namespace
+    dev_t dev;                         //!< the namespace listened in, a VPC created again gets a new one
+    ino_t ino;
+    int fd;                            //!< the listening socket, -1 if there is none yet
+    int listed;                        //!< set if eucanetd still lists the VPC
+} metaproxy_vpc;
+
+//! Where an instance is, from METAPROXY_INSTANCE_MAP_FILE
+typedef struct metaproxy_instance_t {
+    char vpc[16];
+    char name[16];
+    char ip[16];
+} metaproxy_instance;
+
+//! An accepted connection, handed to the thread that serves it
+typedef struct metaproxy_conn_t {
+    int fd;
+    char vpc[16];
+    char ip[16];
+} metaproxy_conn;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static char *eucahome = NULL;
+static char nexthop[64] = METAPROXY_NEXTHOP;
+static int nexthop_port = METAPROXY_NEXTHOP_PORT;
+
+static int root_netns = -1;            //!< the namespace the proxy runs, and connects to the metadata service, in
+static metaproxy_vpc *vpcs = NULL;
+static int max_vpcs = 0;
+static struct stat vpcs_stat = { 0 };  //!< the list the VPCs were last read from
+
+static pthread_mutex_t instances_mutex = PTHREAD_MUTEX_INITIALIZER;
+static metaproxy_instance *instances = NULL;
+static int max_instances = 0;
+static struct stat instances_stat = { 0 };  //!< the map the instances were last read from
+
+static int connections = 0;            //!< connections being served, changed atomically
+static volatile sig_atomic_t metaproxy_stop = 0;
+static volatile sig_atomic_t metaproxy_reload = 0;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void metaproxy_signal(int signum);
+static int metaproxy_daemonize(int debug);
+static int metaproxy_same_file(struct stat *a, struct stat *b);
+static int metaproxy_read_vpcs(void);
+static void metaproxy_sync_vpcs(void);
+static int metaproxy_listen(metaproxy_vpc * vpc, struct stat *nsstat, const char *nspath);
+static void metaproxy_accept(metaproxy_vpc * vpc);
+static void *metaproxy_serve(void *arg);
+static int metaproxy_forward(metaproxy_conn * conn, char *buf, int len);
+static void metaproxy_find_instance(const char *vpc, const char *ip, char *instance, int instance_len);
+static int metaproxy_write(int fd, const char *buf, int len);
+static void metaproxy_error(int fd, const char *status);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MAIN                                     |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int n = 0;
+    int rc = 0;
+    int opt = 0;
+    int debug = 0;
+    int log_level = EUCA_LOG_INFO;
+    time_t now = 0;
+    time_t checked = 0;
+    char logfile[EUCA_MAX_PATH] = "";
+    char pidfile[EUCA_MAX_PATH] = "";
+    struct pollfd *pfds = NULL;
+    metaproxy_vpc **polled = NULL;
+
+    while ((opt = getopt(argc, argv, "dl:n:p:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            debug = 1;
+            break;
+        case 'l':
+            log_level = log_level_int(optarg);
+            break;
+        case 'n':
+            euca_strncpy(nexthop, optarg, sizeof(nexthop));
+            break;
+        case 'p':
+            nexthop_port = atoi(optarg);
+            break;
+        default:
+            printf("USAGE: %s [-d] [-l LEVEL] [-n NEXTHOP] [-p NEXTHOPPORT] EUCALYPTUS\n\t%-12s| debug - run in foreground, all output to terminal\n", argv[0], "-d");
+            exit(1);
+        }
+    }
+
+    if ((optind >= argc) || (nexthop_port <= 0) || (log_level < 0)) {
+        printf("USAGE: %s [-d] [-l LEVEL] [-n NEXTHOP] [-p NEXTHOPPORT] EUCALYPTUS\n\t%-12s| debug - run in foreground, all output to terminal\n", argv[0], "-d");
+        exit(1);
+    }
+    eucahome = argv[optind];
+
+    if ((root_netns = open("/proc/self/ns/net", (O_RDONLY | O_CLOEXEC))) < 0) {
+        fprintf(stderr, "could not open the network namespace of the proxy, exiting\n");
+        exit(1);
+    }
+
+    if (!debug) {
+        snprintf(logfile, EUCA_MAX_PATH, METAPROXY_LOGFILE, eucahome);
+        log_file_set(logfile, NULL);
+    }
+    log_params_set(log_level, 10, 104857600);
+
+    if (metaproxy_daemonize(debug)) {
+        fprintf(stderr, "failed to daemonize the metadata proxy, exiting\n");
+        exit(1);
+    }
+
+    snprintf(pidfile, EUCA_MAX_PATH, METAPROXY_PIDFILE, eucahome);
+    LOGINFO("metadata proxy started, forwarding to %s:%d\n", nexthop, nexthop_port);
+
+    while (!metaproxy_stop) {
+        // cheap enough to do every second, the namespaces are only looked at when something changed
+        now = time(NULL);
+        rc = metaproxy_read_vpcs();
+        if (rc || metaproxy_reload || ((now - checked) >= METAPROXY_CHECK_SEC)) {
+            metaproxy_reload = 0;
+            checked = now;
+            metaproxy_sync_vpcs();
+
+            EUCA_FREE(pfds);
+            EUCA_FREE(polled);
+            pfds = EUCA_ZALLOC((max_vpcs + 1), sizeof(struct pollfd));
+            polled = EUCA_ZALLOC((max_vpcs + 1), sizeof(metaproxy_vpc *));
+            if (!pfds || !polled) {
+                LOGFATAL("out of memory\n");
+                break;
+            }
+        }
+
+        for (i = 0, n = 0; i < max_vpcs; i++) {
+            if (vpcs[i].fd >= 0) {
+                pfds[n].fd = vpcs[i].fd;
+                pfds[n].events = POLLIN;
+                pfds[n].revents = 0;
+                polled[n++] = &(vpcs[i]);
+            }
+        }
+
+        if ((rc = poll(pfds, n, 1000)) < 0) {
+            if (errno != EINTR) {
+                LOGERROR("poll() failed: %s\n", strerror(errno));
+                sleep(1);
+            }
+            continue;
+        }
+
+        for (i = 0; (rc > 0) && (i < n); i++) {
+            if (pfds[i].revents & POLLIN)
+                metaproxy_accept(polled[i]);
+        }
+    }
+
+    LOGINFO("metadata proxy stopping\n");
+    for (i = 0; i < max_vpcs; i++) {
+        if (vpcs[i].fd >= 0)
+            close(vpcs[i].fd);
+    }
+    unlink(pidfile);
+    EUCA_FREE(pfds);
+    EUCA_FREE(polled);
+    EUCA_FREE(vpcs);
+    exit(0);
+}
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Stops the proxy on SIGTERM and SIGINT, looks at the VPCs again on SIGHUP
+//!
+//! @param[in] signum the signal received
+//!
+static void metaproxy_signal(int signum)
+{
+    if (signum == SIGHUP)
+        metaproxy_reload = 1;
+    else
+        metaproxy_stop = 1;
+}
+
+//!
+//! Backgrounds the proxy unless it runs in debug mode, writes its pidfile and installs
+//! its signal handlers. Unlike eucanetd, the proxy keeps its privileges: it needs them to
+//! listen in the namespaces of VPCs created later on.
+//!
+//! @param[in] debug set to stay in the foreground with the output on the terminal
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int metaproxy_daemonize(int debug)
+{
+    int fd = -1;
+    pid_t pid = 0;
+    char pidfile[EUCA_MAX_PATH] = "";
+    FILE *FH = NULL;
+    struct sigaction sa = { {0} };
+
+    if (!debug) {
+        if ((pid = fork()) < 0) {
+            perror("fork()");
+            return (1);
+        } else if (pid > 0) {
+            exit(0);
+        }
+
+        if (setsid() < 0) {
+            perror("setsid()");
+            return (1);
+        }
+
+        if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+            dup2(fd, 0);
+            dup2(fd, 1);
+            dup2(fd, 2);
+            if (fd > 2)
+                close(fd);
+        }
+    }
+
+    snprintf(pidfile, EUCA_MAX_PATH, METAPROXY_PIDFILE, eucahome);
+    if ((FH = fopen(pidfile, "w")) == NULL) {
+        LOGERROR("could not open pidfile for write (%s)\n", pidfile);
+        return (1);
+    }
+    fprintf(FH, "%d\n", getpid());
+    fclose(FH);
+
+    sa.sa_handler = metaproxy_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    return (0);
+}
+
+//!
+//! Tells whether two stat() results are of the same, unchanged, file
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return 1 if they are, 0 otherwise
+//!
+static int metaproxy_same_file(struct stat *a, struct stat *b)
+{
+    return ((a->st_dev == b->st_dev) && (a->st_ino == b->st_ino) && (a->st_size == b->st_size) && (a->st_mtim.tv_sec == b->st_mtim.tv_sec)
+            && (a->st_mtim.tv_nsec == b->st_mtim.tv_nsec));
+}
+
+//!
+//! Reads the list of VPCs to listen in again if eucanetd changed it. VPCs no longer listed
+//! are only marked, metaproxy_sync_vpcs() stops listening in them.
+//!
+//! @return 1 if the list changed, 0 otherwise
+//!
+static int metaproxy_read_vpcs(void)
+{
+    int i = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char line[256] = "";
+    char name[16] = "";
+    FILE *FH = NULL;
+    struct stat mystat = { 0 };
+    metaproxy_vpc *grown = NULL;
+
+    snprintf(path, EUCA_MAX_PATH, METAPROXY_VPCS_FILE, eucahome);
+    if (stat(path, &mystat) < 0)
+        bzero(&mystat, sizeof(struct stat));
+
+    if (metaproxy_same_file(&mystat, &vpcs_stat))
+        return (0);
+    vpcs_stat = mystat;
+
+    for (i = 0; i < max_vpcs; i++)
+        vpcs[i].listed = 0;
+
+    if ((FH = fopen(path, "r")) == NULL) {
+        LOGDEBUG("no VPCs listed in %s\n", path);
+        return (1);
+    }
+
+    while (fgets(line, sizeof(line), FH)) {
+        if ((sscanf(line, "%15s", name) != 1) || (strspn(name, "abcdefghijklmnopqrstuvwxyz0123456789-_") != strlen(name)))
+            continue;
+
+        for (i = 0; (i < max_vpcs) && strcmp(vpcs[i].name, name); i++) ;
+        if (i == max_vpcs) {
+            if ((grown = EUCA_REALLOC(vpcs, (max_vpcs + 1), sizeof(metaproxy_vpc))) == NULL) {
+                LOGFATAL("out of memory\n");
+                break;
+            }
+            vpcs = grown;
+            bzero(&(vpcs[i]), sizeof(metaproxy_vpc));
+            euca_strncpy(vpcs[i].name, name, sizeof(vpcs[i].name));
+            vpcs[i].fd = -1;
+            max_vpcs++;
+        }
+        vpcs[i].listed = 1;
+    }
+    fclose(FH);
+    return (1);
+}
+
+//!
+//! Brings the listening sockets in line with the VPCs listed: stops listening in the VPCs
+//! no longer listed, and starts listening in the new ones and in the ones whose namespace
+//! was created again since.
+//!
+static void metaproxy_sync_vpcs(void)
+{
+    int i = 0;
+    int j = 0;
+    char nspath[EUCA_MAX_PATH] = "";
+    struct stat nsstat = { 0 };
+
+    for (i = 0, j = 0; i < max_vpcs; i++) {
+        if (!vpcs[i].listed) {
+            if (vpcs[i].fd >= 0) {
+                LOGINFO("VPC (%s) is gone, not listening in it anymore\n", vpcs[i].name);
+                close(vpcs[i].fd);
+            }
+            continue;
+        }
+
+        snprintf(nspath, EUCA_MAX_PATH, METAPROXY_NETNS_DIR "/%s", vpcs[i].name);
+        if (stat(nspath, &nsstat) < 0) {
+            // the namespace is not there (yet), let go of the one listened in if any
+            if (vpcs[i].fd >= 0) {
+                LOGINFO("VPC (%s) namespace is gone, not listening in it anymore\n", vpcs[i].name);
+                close(vpcs[i].fd);
+                vpcs[i].fd = -1;
+            }
+        } else if ((vpcs[i].fd < 0) || (nsstat.st_dev != vpcs[i].dev) || (nsstat.st_ino != vpcs[i].ino)) {
+            metaproxy_listen(&(vpcs[i]), &nsstat, nspath);
+        }
+
+        if (i != j)
+            vpcs[j] = vpcs[i];
+        j++;
+    }
+    max_vpcs = j;
+}
+
+//!
+//! Listens in the namespace of a VPC, in place of the namespace it was listening in if any.
+//! The socket is created from within the namespace and keeps belonging to it once the proxy
+//! has gone back to its own.
+//!
+//! @param[in] vpc the VPC to listen in
+//! @param[in] nsstat the stat() of the namespace of the VPC
+//! @param[in] nspath the path to the namespace of the VPC
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int metaproxy_listen(metaproxy_vpc * vpc, struct stat *nsstat, const char *nspath)
+{
+    int fd = -1;
+    int nsfd = -1;
+    int one = 1;
+    int ret = 0;
+    struct sockaddr_in addr = { 0 };
+
+    if (vpc->fd >= 0) {
+        LOGINFO("VPC (%s) namespace was created again, listening in the new one\n", vpc->name);
+        close(vpc->fd);
+        vpc->fd = -1;
+    }
+
+    if ((nsfd = open(nspath, (O_RDONLY | O_CLOEXEC))) < 0) {
+        LOGERROR("cannot open VPC (%s) namespace %s: %s\n", vpc->name, nspath, strerror(errno));
+        return (1);
+    }
+
+    if (setns(nsfd, CLONE_NEWNET) < 0) {
+        LOGERROR("cannot enter VPC (%s) namespace %s: %s\n", vpc->name, nspath, strerror(errno));
+        close(nsfd);
+        return (1);
+    }
+    close(nsfd);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(METAPROXY_PORT);
+    if ((fd = socket(AF_INET, (SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0)) < 0) {
+        LOGERROR("cannot create socket in VPC (%s) namespace: %s\n", vpc->name, strerror(errno));
+        ret = 1;
+    } else if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) || bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+               || listen(fd, METAPROXY_BACKLOG)) {
+        LOGERROR("cannot listen on port %d in VPC (%s) namespace: %s\n", METAPROXY_PORT, vpc->name, strerror(errno));
+        close(fd);
+        fd = -1;
+        ret = 1;
+    }
+
+    // connections to the metadata service must come from our own namespace, there is no going on without it
+    if (setns(root_netns, CLONE_NEWNET) < 0) {
+        LOGFATAL("cannot go back to the namespace of the proxy: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    if (!ret) {
+        LOGINFO("listening in VPC (%s) namespace\n", vpc->name);
+        vpc->fd = fd;
+        vpc->dev = nsstat->st_dev;
+        vpc->ino = nsstat->st_ino;
+    }
+    return (ret);
+}
+
+//!
+//! Accepts the pending connections on the socket of a VPC, each one served by a thread
+//!
+//! @param[in] vpc the VPC with pending connections
+//!
+static void metaproxy_accept(metaproxy_vpc * vpc)
+{
+    int fd = -1;
+    socklen_t len = 0;
+    pthread_t thread;
+    pthread_attr_t attr;
+    struct sockaddr_in client = { 0 };
+    struct timeval timeout = { METAPROXY_IO_TIMEOUT_SEC, 0 };
+    metaproxy_conn *conn = NULL;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        len = sizeof(client);
+        if ((fd = accept4(vpc->fd, (struct sockaddr *)&client, &len, SOCK_CLOEXEC)) < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+                LOGWARN("cannot accept connection in VPC (%s): %s\n", vpc->name, strerror(errno));
+            break;
+        }
+
+        if (__sync_add_and_fetch(&connections, 1) > METAPROXY_MAX_CONNECTIONS) {
+            LOGWARN("too many connections, dropping one from VPC (%s)\n", vpc->name);
+            __sync_sub_and_fetch(&connections, 1);
+            close(fd);
+            continue;
+        }
+
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if ((conn = EUCA_ZALLOC(1, sizeof(metaproxy_conn))) != NULL) {
+            conn->fd = fd;
+            euca_strncpy(conn->vpc, vpc->name, sizeof(conn->vpc));
+            inet_ntop(AF_INET, &(client.sin_addr), conn->ip, sizeof(conn->ip));
+            if (pthread_create(&thread, &attr, metaproxy_serve, conn) == 0)
+                continue;
+            EUCA_FREE(conn);
+        }
+        LOGERROR("cannot serve connection from VPC (%s)\n", vpc->name);
+        __sync_sub_and_fetch(&connections, 1);
+        close(fd);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+//!
+//! Serves one connection: reads the request header and forwards the request
+//!
+//! @param[in] arg the metaproxy_conn of the connection, freed when done
+//!
+//! @return NULL
+//!
+static void *metaproxy_serve(void *arg)
+{
+    int len = 0;
+    int bytes = 0;
+    char *buf = NULL;
+    metaproxy_conn *conn = arg;
+
+    if ((buf = EUCA_ALLOC((METAPROXY_HEADER_MAX + 1), sizeof(char))) != NULL) {
+        while (len < METAPROXY_HEADER_MAX) {
+            if ((bytes = read(conn->fd, (buf + len), (METAPROXY_HEADER_MAX - len))) < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            if (bytes == 0)
+                break;
+            len += bytes;
+            buf[len] = '\0';
+            if (strstr(buf, "\r\n\r\n"))
+                break;
+        }
+
+        if (len && strstr(buf, "\r\n\r\n")) {
+            metaproxy_forward(conn, buf, len);
+        } else if (len) {
+            metaproxy_error(conn->fd, "400 Bad Request");
+        }
+        EUCA_FREE(buf);
+    }
+
+    close(conn->fd);
+    EUCA_FREE(conn);
+    __sync_sub_and_fetch(&connections, 1);
+    return (NULL);
+}
+
+//!
+//! Forwards a request to the metadata service and its response back. The header is passed
+//! on with the instance the request comes from in METAPROXY_INSTANCE_HEADER, in place of
+//! any the instance sent, and asks for the connection to be closed, so a request is all
+//! that goes through a connection and no instance gets to send a header of its own.
+//!
+//! @param[in] conn the connection
+//! @param[in] buf what was read from the connection, the whole header and maybe some of the body
+//! @param[in] len the number of bytes in buf
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int metaproxy_forward(metaproxy_conn * conn, char *buf, int len)
+{
+    int fd = -1;
+    int ret = 0;
+    int bytes = 0;
+    int hdrlen = 0;
+    int outlen = 0;
+    long body = 0;
+    char *line = NULL;
+    char *eol = NULL;
+    char *out = NULL;
+    char instance[16] = "";
+    struct sockaddr_in addr = { 0 };
+    struct timeval timeout = { METAPROXY_IO_TIMEOUT_SEC, 0 };
+
+    hdrlen = (strstr(buf, "\r\n\r\n") - buf) + 4;
+    if ((out = EUCA_ALLOC((hdrlen + 128), sizeof(char))) == NULL) {
+        metaproxy_error(conn->fd, "500 Internal Server Error");
+        return (1);
+    }
+
+    metaproxy_find_instance(conn->vpc, conn->ip, instance, sizeof(instance));
+    for (line = buf; (eol = strstr(line, "\r\n")) && (eol != line); line = eol + 2) {
+        *eol = '\0';
+        if (line == buf) {
+            // the request line
+        } else if (!strncasecmp(line, METAPROXY_INSTANCE_HEADER ":", strlen(METAPROXY_INSTANCE_HEADER ":"))
+                   || !strncasecmp(line, "Connection:", 11) || !strncasecmp(line, "Keep-Alive:", 11) || !strncasecmp(line, "Proxy-Connection:", 17)) {
+            continue;
+        } else if (!strncasecmp(line, "Transfer-Encoding:", 18)) {
+            metaproxy_error(conn->fd, "411 Length Required");
+            EUCA_FREE(out);
+            return (1);
+        } else if (!strncasecmp(line, "Content-Length:", 15)) {
+            if ((body = atol(line + 15)) < 0)
+                body = 0;
+        }
+        outlen += snprintf((out + outlen), (hdrlen + 128 - outlen), "%s\r\n", line);
+    }
+    outlen += snprintf((out + outlen), (hdrlen + 128 - outlen), METAPROXY_INSTANCE_HEADER ": %s\r\nConnection: close\r\n\r\n", (instance[0] ? instance : "UNSET"));
+    LOGTRACE("VPC (%s) %s (%s): %s\n", conn->vpc, conn->ip, instance, buf);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(nexthop_port);
+    if ((inet_pton(AF_INET, nexthop, &(addr.sin_addr)) != 1) || ((fd = socket(AF_INET, (SOCK_STREAM | SOCK_CLOEXEC), 0)) < 0)
+        || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) || setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))
+        || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        LOGERROR("cannot connect to the metadata service at %s:%d: %s\n", nexthop, nexthop_port, strerror(errno));
+        metaproxy_error(conn->fd, "502 Bad Gateway");
+        if (fd >= 0)
+            close(fd);
+        EUCA_FREE(out);
+        return (1);
+    }
+    // the header, then the body: what was read of it with the header and the rest
+    bytes = ((len - hdrlen) < body) ? (len - hdrlen) : body;
+    if (metaproxy_write(fd, out, outlen) || metaproxy_write(fd, (buf + hdrlen), bytes)) {
+        ret = 1;
+    }
+    for (body -= bytes; !ret && (body > 0); body -= bytes) {
+        if ((bytes = read(conn->fd, buf, ((body < METAPROXY_HEADER_MAX) ? body : METAPROXY_HEADER_MAX))) <= 0) {
+            if ((bytes < 0) && (errno == EINTR)) {
+                bytes = 0;
+                continue;
+            }
+            ret = 1;
+        } else if (metaproxy_write(fd, buf, bytes)) {
+            ret = 1;
+        }
+    }
+
+    while (!ret) {
+        if ((bytes = read(fd, buf, METAPROXY_HEADER_MAX)) < 0) {
+            if (errno == EINTR)
+                continue;
+            ret = 1;
+        } else if (bytes == 0) {
+            break;
+        } else if (metaproxy_write(conn->fd, buf, bytes)) {
+            ret = 1;
+        }
+    }
+
+    if (ret)
+        LOGDEBUG("could not forward request from VPC (%s) %s: %s\n", conn->vpc, conn->ip, strerror(errno));
+    close(fd);
+    EUCA_FREE(out);
+    return (ret);
+}
+
+//!
+//! Looks up the instance that has a private IP in a VPC, reading the map eucanetd writes
+//! again only if it changed since it was last read
+//!
+//! @param[in]  vpc the VPC
+//! @param[in]  ip the private IP
+//! @param[out] instance set to the instance, or to "" if there is none
+//! @param[in]  instance_len the size of instance
+//!
+static void metaproxy_find_instance(const char *vpc, const char *ip, char *instance, int instance_len)
+{
+    int i = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char line[256] = "";
+    FILE *FH = NULL;
+    struct stat mystat = { 0 };
+    metaproxy_instance entry = { "" };
+    metaproxy_instance *grown = NULL;
+
+    instance[0] = '\0';
+    snprintf(path, EUCA_MAX_PATH, METAPROXY_INSTANCE_MAP_FILE, eucahome);
+
+    pthread_mutex_lock(&instances_mutex);
+    if (stat(path, &mystat) < 0)
+        bzero(&mystat, sizeof(struct stat));
+
+    if (!metaproxy_same_file(&mystat, &instances_stat)) {
+        instances_stat = mystat;
+        max_instances = 0;
+        if ((FH = fopen(path, "r")) != NULL) {
+            while (fgets(line, sizeof(line), FH)) {
+                if (sscanf(line, "%15s %15s %15s", entry.vpc, entry.name, entry.ip) != 3)
+                    continue;
+
+                if ((grown = EUCA_REALLOC(instances, (max_instances + 1), sizeof(metaproxy_instance))) == NULL)
+                    break;
+                instances = grown;
+                instances[max_instances++] = entry;
+            }
+            fclose(FH);
+        }
+        LOGDEBUG("read %d instances from %s\n", max_instances, path);
+    }
+
+    for (i = 0; i < max_instances; i++) {
+        if (!strcmp(instances[i].ip, ip) && !strcmp(instances[i].vpc, vpc)) {
+            euca_strncpy(instance, instances[i].name, instance_len);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&instances_mutex);
+}
+
+//!
+//! Writes all of a buffer to a socket
+//!
+//! @param[in] fd the socket
+//! @param[in] buf the buffer
+//! @param[in] len the number of bytes to write
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int metaproxy_write(int fd, const char *buf, int len)
+{
+    int bytes = 0;
+
+    while (len > 0) {
+        if ((bytes = write(fd, buf, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (1);
+        }
+        buf += bytes;
+        len -= bytes;
+    }
+    return (0);
+}
+
+//!
+//! Answers a request the proxy cannot forward
+//!
+//! @param[in] fd the connection
+//! @param[in] status the HTTP status code and reason
+//!
+static void metaproxy_error(int fd, const char *status)
+{
+    char response[256] = "";
+
+    snprintf(response, sizeof(response), "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    metaproxy_write(fd, response, strlen(response));
+}
@@ -80,6 +80,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/select.h>
 #include <pwd.h>
 #include <dirent.h>
 #include <errno.h>
@@ -109,6 +110,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define MIDONET_HTTP_MAX_PARALLEL                8  //!< most requests midonet_http_multi() keeps in flight
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -141,6 +144,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! handles and connections to the MidoNet API, kept for the life of the process
+static int midonet_curl_initialized = 0;
+static CURL *midonet_curl = NULL;
+static CURLM *midonet_curlm = NULL;
+static CURL *midonet_curl_pool[MIDONET_HTTP_MAX_PARALLEL] = { NULL };
+
 void mido_print_midoname(midoname * name)
 {
     //    printf("init=%d tenant=%s name=%s uuid=%s resource_type=%s content_type=%s jsonbuf=%s\n", name->init, SP(name->tenant), SP(name->name), SP(name->uuid), SP(name->resource_type), SP(name->content_type), SP(name->jsonbuf));
@@ -837,6 +846,11 @@ int mido_get_ports(midoname * devname, midoname ** outnames, int *outnames_max)
     return (mido_get_resources(devname, 1, devname->tenant, "ports", "application/vnd.org.midonet.collection.Port-v2+json", outnames, outnames_max));
 }
 
+int mido_get_ports_all(midoname * devnames, int max_devnames, midoname ** outnames, int *outnames_max)
+{
+    return (mido_get_resources_all(devnames, max_devnames, "ports", "application/vnd.org.midonet.collection.Port-v2+json", outnames, outnames_max));
+}
+
 int mido_get_rules(midoname * chainname, midoname ** outnames, int *outnames_max)
 {
     return (mido_get_resources(chainname, 1, chainname->tenant, "rules", "application/vnd.org.midonet.collection.Rule-v2+json", outnames, outnames_max));
@@ -1134,6 +1148,25 @@ char *mido_jsonize(char *tenant, va_list * al)
     return (payload);
 }
 
+//!
+//! Builds a JSON payload from a NULL terminated list of key/value pairs, see mido_jsonize().
+//!
+//! @param[in] tenant the tenant to add to the payload, or NULL
+//! @param[in] ... the key/value pairs, followed by NULL
+//!
+//! @return a newly allocated payload the caller must free, or NULL on failure
+//!
+char *mido_jsonize_args(char *tenant, ...)
+{
+    char *payload = NULL;
+    va_list al = { {0} };
+
+    va_start(al, tenant);
+    payload = mido_jsonize(tenant, &al);
+    va_end(al);
+    return (payload);
+}
+
 int mido_create_resource(midoname * parents, int max_parents, midoname * newname, midoname * outname, ...)
 {
     int ret = 0;
@@ -1360,16 +1393,17 @@ int mido_update_midoname(midoname * name)
     return (ret);
 }
 
-int mido_delete_resource(midoname * parentname, midoname * name)
+//!
+//! Builds the URL of a resource, which is the one the API gave it when there is one
+//!
+//! @param[in]  parentname the resource the resource is nested under (may be NULL)
+//! @param[in]  name the resource
+//! @param[out] url buffer of EUCA_MAX_PATH bytes for the URL
+//!
+static void mido_resource_url(midoname * parentname, midoname * name, char *url)
 {
-    int rc = 0, ret = 0;
-    char url[EUCA_MAX_PATH];
     json_object *jobj = NULL, *el = NULL;
 
-    if (!name || !name->init) {
-        return (0);
-    }
-
     url[0] = '\0';
 
     jobj = json_tokener_parse(name->jsonbuf);
@@ -1389,6 +1423,18 @@ int mido_delete_resource(midoname * parentname, midoname * name)
             snprintf(url, EUCA_MAX_PATH, "http://localhost:8080/midonet-api/%s/%s", name->resource_type, name->uuid);
         }
     }
+}
+
+int mido_delete_resource(midoname * parentname, midoname * name)
+{
+    int rc = 0, ret = 0;
+    char url[EUCA_MAX_PATH];
+
+    if (!name || !name->init) {
+        return (0);
+    }
+
+    mido_resource_url(parentname, name, url);
 
     LOGTRACE("resource to delete: %s/%s url to delete: %s\n", SP(name->name), SP(name->uuid), url);
 
@@ -1450,6 +1496,31 @@ static size_t mem_reader(void *contents, size_t size, size_t nmemb, void *in_par
     return (bytes_to_copy);
 }
 
+//!
+//! Returns the handle the single REST requests go through. It is kept for the life of the
+//! process so that its connections to the MidoNet API stay open between requests.
+//!
+//! @return the handle, reset to its defaults, or NULL if it could not be created
+//!
+static CURL *midonet_http_handle(void)
+{
+    if (!midonet_curl_initialized) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        midonet_curl_initialized = 1;
+    }
+
+    if (!midonet_curl) {
+        if ((midonet_curl = curl_easy_init()) == NULL) {
+            LOGERROR("could not initialize a handle for the midonet API\n");
+            return (NULL);
+        }
+    } else {
+        // this keeps the open connections and the DNS cache
+        curl_easy_reset(midonet_curl);
+    }
+    return (midonet_curl);
+}
+
 int midonet_http_get(char *url, char *apistr, char **out_payload)
 {
     CURL *curl = NULL;
@@ -1462,7 +1533,9 @@ int midonet_http_get(char *url, char *apistr, char **out_payload)
 
     *out_payload = NULL;
 
-    curl = curl_easy_init();
+    if ((curl = midonet_http_handle()) == NULL) {
+        return (1);
+    }
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, mem_writer);
@@ -1491,8 +1564,7 @@ int midonet_http_get(char *url, char *apistr, char **out_payload)
     if (httpcode != 200L) {
         ret = 1;
     }
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
+    curl_slist_free_all(headers);
 
     // convert to payload out
 
@@ -1523,7 +1595,9 @@ int midonet_http_put(char *url, char *resource_type, char *payload)
     mem_reader_params.mem = payload;
     mem_reader_params.size = strlen(payload) + 1;
 
-    curl = curl_easy_init();
+    if ((curl = midonet_http_handle()) == NULL) {
+        return (1);
+    }
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
     curl_easy_setopt(curl, CURLOPT_PUT, 1L);
@@ -1548,8 +1622,6 @@ int midonet_http_put(char *url, char *resource_type, char *payload)
     }
 
     curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
 
     return (ret);
 }
@@ -1582,7 +1654,9 @@ int midonet_http_post(char *url, char *resource_type, char *payload, char **out_
 
     *out_payload = NULL;
 
-    curl = curl_easy_init();
+    if ((curl = midonet_http_handle()) == NULL) {
+        return (1);
+    }
     curl_easy_setopt(curl, CURLOPT_URL, url);
     //    curl_easy_setopt(curl, CURLOPT_HEADER, 1L);
     curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
@@ -1607,8 +1681,6 @@ int midonet_http_post(char *url, char *resource_type, char *payload, char **out_
     }
 
     curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
 
     if (!ret) {
         if (loc) {
@@ -1626,7 +1698,9 @@ int midonet_http_delete(char *url)
     CURLcode curlret;
     int ret = 0;
 
-    curl = curl_easy_init();
+    if ((curl = midonet_http_handle()) == NULL) {
+        return (1);
+    }
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
     curlret = curl_easy_perform(curl);
@@ -1634,12 +1708,248 @@ int midonet_http_delete(char *url)
         printf("ERROR: curl_easy_perform(): %s\n", curl_easy_strerror(curlret));
         ret = 1;
     }
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
 
     return (ret);
 }
 
+//!
+//! Issues several requests of the same kind against the MidoNet API at once, keeping up to
+//! MIDONET_HTTP_MAX_PARALLEL of them in flight over connections that stay open between calls.
+//!
+//! @param[in]  method "GET", "POST" or "DELETE"
+//! @param[in]  urls the URLs to send the requests to
+//! @param[in]  max_urls number of URLs
+//! @param[in]  mediatype the accept header of GETs or the resource type of the POSTed payloads (may be NULL)
+//! @param[in]  payloads array of max_urls bodies to POST, NULL for GETs and DELETEs
+//! @param[out] out_payloads array of max_urls entries set to the response body of each GET, or to
+//!             the location of the resource each POST created, or to NULL for the requests that
+//!             failed. The strings are to be freed by the caller. May be NULL for POSTs and DELETEs.
+//!
+//! @return 0 if all the requests succeeded or 1 if any failed
+//!
+static int midonet_http_multi(const char *method, char **urls, int max_urls, char *mediatype, char **payloads, char **out_payloads)
+{
+    int i = 0;
+    int s = 0;
+    int ret = 0;
+    int next = 0;
+    int active = 0;
+    int running = 0;
+    int left = 0;
+    int maxfd = -1;
+    int is_get = !strcmp(method, "GET");
+    int is_post = !strcmp(method, "POST");
+    int slot_url[MIDONET_HTTP_MAX_PARALLEL];
+    long httpcode = 0L;
+    long timeout = 0L;
+    char hbuf[EUCA_MAX_PATH];
+    char **locs = NULL;
+    CURL *curl = NULL;
+    CURLcode curlret;
+    CURLMsg *msg = NULL;
+    struct curl_slist *headers = NULL;
+    struct mem_params_t *params = NULL;
+    struct timeval tv;
+    fd_set rfds, wfds, efds;
+
+    if (!urls || (max_urls < 0) || (is_get && !out_payloads) || (is_post && !payloads)) {
+        LOGERROR("invalid input\n");
+        return (1);
+    }
+
+    for (i = 0; out_payloads && (i < max_urls); i++) {
+        out_payloads[i] = NULL;
+    }
+    if (max_urls == 0) {
+        return (0);
+    }
+
+    if (!midonet_curl_initialized) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        midonet_curl_initialized = 1;
+    }
+    if (!midonet_curlm && ((midonet_curlm = curl_multi_init()) == NULL)) {
+        LOGERROR("could not initialize a multi handle for the midonet API\n");
+        return (1);
+    }
+    for (s = 0; s < MIDONET_HTTP_MAX_PARALLEL; s++) {
+        if (!midonet_curl_pool[s] && ((midonet_curl_pool[s] = curl_easy_init()) == NULL)) {
+            LOGERROR("could not initialize a handle for the midonet API\n");
+            return (1);
+        }
+        slot_url[s] = -1;
+    }
+
+    params = EUCA_ZALLOC(max_urls, sizeof(struct mem_params_t));
+    locs = EUCA_ZALLOC(max_urls, sizeof(char *));
+    if (!params || !locs) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(params);
+        EUCA_FREE(locs);
+        return (1);
+    }
+
+    if (is_get && mediatype && strlen(mediatype)) {
+        snprintf(hbuf, EUCA_MAX_PATH, "accept: %s", mediatype);
+        headers = curl_slist_append(headers, hbuf);
+    } else if (is_post) {
+        if (!mediatype || (strlen(mediatype) <= 0)) {
+            snprintf(hbuf, EUCA_MAX_PATH, "Content-Type: application/json");
+        } else {
+            snprintf(hbuf, EUCA_MAX_PATH, "Content-Type: application/vnd.org.midonet.%s-v1+json", mediatype);
+        }
+        headers = curl_slist_append(headers, hbuf);
+    }
+
+    while ((next < max_urls) || active) {
+        // hand the next URLs to the idle handles
+        for (s = 0; (s < MIDONET_HTTP_MAX_PARALLEL) && (next < max_urls); s++) {
+            if (slot_url[s] < 0) {
+                curl = midonet_curl_pool[s];
+                curl_easy_reset(curl);
+                curl_easy_setopt(curl, CURLOPT_URL, urls[next]);
+                if (is_get) {
+                    curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+                    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, mem_writer);
+                    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&(params[next]));
+                } else if (is_post) {
+                    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+                    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+                    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payloads[next]);
+                    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(payloads[next]));
+                    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_find_location);
+                    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &(locs[next]));
+                } else {
+                    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+                }
+                if (headers) {
+                    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+                }
+                curl_multi_add_handle(midonet_curlm, curl);
+                slot_url[s] = next++;
+                active++;
+            }
+        }
+
+        while (curl_multi_perform(midonet_curlm, &running) == CURLM_CALL_MULTI_PERFORM) ;
+
+        while ((msg = curl_multi_info_read(midonet_curlm, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            curl = msg->easy_handle;
+            curlret = msg->data.result;
+            for (s = 0; (s < MIDONET_HTTP_MAX_PARALLEL) && (midonet_curl_pool[s] != curl); s++) ;
+            if (s == MIDONET_HTTP_MAX_PARALLEL) {
+                continue;
+            }
+            i = slot_url[s];
+
+            httpcode = 0L;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
+            if (curlret != CURLE_OK) {
+                LOGERROR("%s of %s failed: %s\n", method, urls[i], curl_easy_strerror(curlret));
+                ret = 1;
+            } else if (is_get ? (httpcode != 200L) : ((httpcode < 200L) || (httpcode > 299L))) {
+                LOGDEBUG("%s of %s returned HTTP %ld\n", method, urls[i], httpcode);
+                ret = 1;
+            } else if (is_get && (!params[i].mem || (params[i].size <= 0))) {
+                LOGERROR("no data to return after successful request to %s\n", urls[i]);
+                ret = 1;
+            } else if (is_get) {
+                out_payloads[i] = params[i].mem;
+                params[i].mem = NULL;
+            } else if (out_payloads) {
+                out_payloads[i] = locs[i];
+                locs[i] = NULL;
+            }
+
+            curl_multi_remove_handle(midonet_curlm, curl);
+            slot_url[s] = -1;
+            active--;
+        }
+
+        // wait for some of the transfers in flight to make progress
+        if (active && running) {
+            FD_ZERO(&rfds);
+            FD_ZERO(&wfds);
+            FD_ZERO(&efds);
+            maxfd = -1;
+            timeout = -1L;
+            curl_multi_fdset(midonet_curlm, &rfds, &wfds, &efds, &maxfd);
+            curl_multi_timeout(midonet_curlm, &timeout);
+            if ((timeout < 0L) || (timeout > 1000L)) {
+                timeout = 1000L;
+            }
+            if (maxfd < 0) {
+                // nothing to wait on yet (e.g. still resolving), as advised by libcurl
+                timeout = 100L;
+            }
+            tv.tv_sec = timeout / 1000L;
+            tv.tv_usec = (timeout % 1000L) * 1000L;
+            select(maxfd + 1, &rfds, &wfds, &efds, &tv);
+        }
+    }
+
+    for (i = 0; i < max_urls; i++) {
+        EUCA_FREE(params[i].mem);
+        EUCA_FREE(locs[i]);
+    }
+    EUCA_FREE(params);
+    EUCA_FREE(locs);
+    curl_slist_free_all(headers);
+
+    return (ret);
+}
+
+//!
+//! Issues several GET requests against the MidoNet API at once. Meant for the independent
+//! reads done while discovering and populating.
+//!
+//! @param[in]  urls the URLs to get
+//! @param[in]  max_urls number of URLs
+//! @param[in]  apistr the accept header to send (may be NULL)
+//! @param[out] out_payloads array of max_urls entries set to the response body of each URL,
+//!             or to NULL for the requests that failed. The bodies are to be freed by the caller.
+//!
+//! @return 0 if all the requests succeeded or 1 if any failed
+//!
+int midonet_http_get_multi(char **urls, int max_urls, char *apistr, char **out_payloads)
+{
+    return (midonet_http_multi("GET", urls, max_urls, apistr, NULL, out_payloads));
+}
+
+//!
+//! Issues several POST requests against the MidoNet API at once, for creating resources that
+//! do not depend on each other
+//!
+//! @param[in]  urls the URLs of the collections to create the resources in
+//! @param[in]  max_urls number of URLs
+//! @param[in]  resource_type the type of the resources, for the Content-Type header (may be NULL)
+//! @param[in]  payloads the JSON payload of each resource
+//! @param[out] out_locations array of max_urls entries set to the location of each resource
+//!             created, or to NULL for the requests that failed (may be NULL)
+//!
+//! @return 0 if all the requests succeeded or 1 if any failed
+//!
+int midonet_http_post_multi(char **urls, int max_urls, char *resource_type, char **payloads, char **out_locations)
+{
+    return (midonet_http_multi("POST", urls, max_urls, resource_type, payloads, out_locations));
+}
+
+//!
+//! Issues several DELETE requests against the MidoNet API at once
+//!
+//! @param[in] urls the URLs of the resources to delete
+//! @param[in] max_urls number of URLs
+//!
+//! @return 0 if all the requests succeeded or 1 if any failed
+//!
+int midonet_http_delete_multi(char **urls, int max_urls)
+{
+    return (midonet_http_multi("DELETE", urls, max_urls, NULL, NULL, NULL));
+}
+
 int mido_create_route(midoname * router, midoname * rport, char *src, char *src_slashnet, char *dst, char *dst_slashnet, char *next_hop_ip, char *weight, midoname * outname)
 {
     int rc = 0, found = 0, ret = 0;
@@ -1873,15 +2183,19 @@ int mido_get_chains(char *tenant, midoname ** outnames, int *outnames_max)
     return (mido_get_resources(NULL, 0, tenant, "chains", "application/vnd.org.midonet.collection.Chain-v1+json", outnames, outnames_max));
 }
 
-int mido_get_resources(midoname * parents, int max_parents, char *tenant, char *resource_type, char *apistr, midoname ** outnames, int *outnames_max)
+//!
+//! Builds the URL of a collection of resources
+//!
+//! @param[in]  parents the resources the collection is nested under, outermost first
+//! @param[in]  max_parents number of parents
+//! @param[in]  tenant the tenant
+//! @param[in]  resource_type the type of the resources in the collection
+//! @param[out] url buffer of EUCA_MAX_PATH bytes for the URL
+//!
+static void mido_resources_url(midoname * parents, int max_parents, char *tenant, char *resource_type, char *url)
 {
-    int rc = 0, ret = 0, i = 0;
-    char *payload = NULL, url[EUCA_MAX_PATH], tmpbuf[EUCA_MAX_PATH];
-    midoname *names = NULL;
-    int names_max = 0;
-
-    *outnames = NULL;
-    *outnames_max = 0;
+    int i = 0;
+    char tmpbuf[EUCA_MAX_PATH];
 
     bzero(url, EUCA_MAX_PATH);
     if (!parents) {
@@ -1897,59 +2211,348 @@ int mido_get_resources(midoname * parents, int max_parents, char *tenant, char *
         snprintf(tmpbuf, EUCA_MAX_PATH, "%s?tenant_id=%s", resource_type, tenant);
         strcat(url, tmpbuf);
     }
-    //    snprintf(url, EUCA_MAX_PATH, "http://localhost:8080/midonet-api/%s?tenant_id=%s", resource_type, tenant);
-    rc = midonet_http_get(url, apistr, &payload);
-    //    LOGDEBUG("PAYLOAD: %s %s '%s' '%s' '%d' \n", SP(url), SP(payload), SP(resource_type), SP(tenant), max_parents);
-    if (!rc) {
-        struct json_object *jobj = NULL, *resource = NULL;
+}
 
-        jobj = json_tokener_parse(payload);
-        if (!jobj) {
-            printf("NOU\n");
-        } else {
-            //            jobj = json_object_get(jobj);
-            if (json_object_is_type(jobj, json_type_array)) {
+//!
+//! Turns a collection returned by the API into midonames, appended to a list
+//!
+//! @param[in]     payload the JSON array returned by the API
+//! @param[in]     tenant the tenant
+//! @param[in]     resource_type the type of the resources in the collection
+//! @param[in,out] names pointer to the list to append to
+//! @param[in,out] names_max pointer to the number of names in the list
+//!
+static void mido_resources_parse(char *payload, char *tenant, char *resource_type, midoname ** names, int *names_max)
+{
+    int i = 0;
+    struct json_object *jobj = NULL, *resource = NULL;
 
-                names_max = 0;
-                names = calloc(json_object_array_length(jobj), sizeof(midoname));
+    jobj = json_tokener_parse(payload);
+    if (!jobj) {
+        printf("NOU\n");
+    } else {
+        //            jobj = json_object_get(jobj);
+        if (json_object_is_type(jobj, json_type_array) && (json_object_array_length(jobj) > 0)) {
 
-                for (i = 0; i < json_object_array_length(jobj); i++) {
+            *names = realloc(*names, sizeof(midoname) * (*names_max + json_object_array_length(jobj)));
 
-                    resource = json_object_array_get_idx(jobj, i);
-                    if (resource) {
+            for (i = 0; i < json_object_array_length(jobj); i++) {
 
-                        /*
-                           json_object_object_foreach(resource, key, val) {
-                           printf("\t%s: %s\n", key, SP(json_object_get_string(val)));
-                           }
-                         */
+                resource = json_object_array_get_idx(jobj, i);
+                if (resource) {
 
-                        names[names_max].tenant = strdup(tenant);
-                        names[names_max].jsonbuf = strdup(json_object_to_json_string(resource));
-                        names[names_max].resource_type = strdup(resource_type);
-                        names[names_max].content_type = NULL;
-                        names[names_max].init = 1;
-                        mido_update_midoname(&(names[names_max]));
-                        names_max++;
+                    /*
+                       json_object_object_foreach(resource, key, val) {
+                       printf("\t%s: %s\n", key, SP(json_object_get_string(val)));
+                       }
+                     */
 
-                        //                        json_object_put(resource);
-                    }
+                    bzero(&((*names)[*names_max]), sizeof(midoname));
+                    (*names)[*names_max].tenant = strdup(tenant);
+                    (*names)[*names_max].jsonbuf = strdup(json_object_to_json_string(resource));
+                    (*names)[*names_max].resource_type = strdup(resource_type);
+                    (*names)[*names_max].content_type = NULL;
+                    (*names)[*names_max].init = 1;
+                    mido_update_midoname(&((*names)[*names_max]));
+                    (*names_max)++;
+
+                    //                        json_object_put(resource);
                 }
             }
-            json_object_put(jobj);
         }
+        json_object_put(jobj);
+    }
+}
+
+int mido_get_resources(midoname * parents, int max_parents, char *tenant, char *resource_type, char *apistr, midoname ** outnames, int *outnames_max)
+{
+    int rc = 0, ret = 0;
+    char *payload = NULL, url[EUCA_MAX_PATH];
+    midoname *names = NULL;
+    int names_max = 0;
+
+    *outnames = NULL;
+    *outnames_max = 0;
+
+    mido_resources_url(parents, max_parents, tenant, resource_type, url);
+    //    snprintf(url, EUCA_MAX_PATH, "http://localhost:8080/midonet-api/%s?tenant_id=%s", resource_type, tenant);
+    rc = midonet_http_get(url, apistr, &payload);
+    //    LOGDEBUG("PAYLOAD: %s %s '%s' '%s' '%d' \n", SP(url), SP(payload), SP(resource_type), SP(tenant), max_parents);
+    if (!rc) {
+        mido_resources_parse(payload, tenant, resource_type, &names, &names_max);
         EUCA_FREE(payload);
     }
 
     if (names && (names_max > 0)) {
         //        LOGINFO("WTF: %s %d, %d, %08X\n", resource_type, names_max, sizeof(midoname), *outnames);
-        *outnames = calloc(names_max, sizeof(midoname));
-        memcpy(*outnames, names, sizeof(midoname) * names_max);
+        *outnames = names;
         *outnames_max = names_max;
+    } else {
+        EUCA_FREE(names);
     }
-    //    mido_free_midoname_list(names, names_max);
+
+    return (ret);
+}
+
+//!
+//! Gets a collection of resources under each of several devices, with the requests going
+//! out in parallel. The results come back in a single list, in device order, the same as
+//! calling mido_get_resources() on each device in turn and joining the lists.
+//!
+//! @param[in]  devices the devices
+//! @param[in]  max_devices number of devices
+//! @param[in]  resource_type the type of the resources to get under each device
+//! @param[in]  apistr the media type of the collection
+//! @param[out] outnames the resources found
+//! @param[out] outnames_max number of resources found
+//!
+//! @return 0 on success or 1 if any of the requests failed, in which case outnames holds
+//!         what the other requests returned
+//!
+int mido_get_resources_all(midoname * devices, int max_devices, char *resource_type, char *apistr, midoname ** outnames, int *outnames_max)
+{
+    int i = 0, ret = 0;
+    char **urls = NULL, **payloads = NULL;
+    midoname *names = NULL;
+    int names_max = 0;
+
+    *outnames = NULL;
+    *outnames_max = 0;
+
+    if (max_devices <= 0) {
+        return (0);
+    }
+
+    urls = EUCA_ZALLOC(max_devices, sizeof(char *));
+    payloads = EUCA_ZALLOC(max_devices, sizeof(char *));
+    if (!urls || !payloads) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(urls);
+        EUCA_FREE(payloads);
+        return (1);
+    }
+
+    for (i = 0; i < max_devices; i++) {
+        urls[i] = EUCA_ZALLOC(EUCA_MAX_PATH, sizeof(char));
+        if (urls[i]) {
+            mido_resources_url(&(devices[i]), 1, devices[i].tenant, resource_type, urls[i]);
+        } else {
+            ret = 1;
+        }
+    }
+
+    if (!ret && midonet_http_get_multi(urls, max_devices, apistr, payloads)) {
+        ret = 1;
+    }
+
+    for (i = 0; i < max_devices; i++) {
+        if (payloads[i]) {
+            mido_resources_parse(payloads[i], devices[i].tenant, resource_type, &names, &names_max);
+        }
+        EUCA_FREE(payloads[i]);
+        EUCA_FREE(urls[i]);
+    }
+    EUCA_FREE(payloads);
+    EUCA_FREE(urls);
+
+    if (names && (names_max > 0)) {
+        *outnames = names;
+        *outnames_max = names_max;
+    } else {
+        EUCA_FREE(names);
+    }
+
+    return (ret);
+}
+
+//!
+//! Brings a collection of resources under a parent in line with the list of resources it is to
+//! hold. The collection is read once and compared with the list locally, then only the missing
+//! resources are created and only the ones the list does not hold are deleted, all with
+//! requests that go out in parallel. The order of the resources in the collection is not
+//! kept, so this is for collections in which it does not matter, such as chains of accept rules.
+//!
+//! @param[in] parent the resource the collection is nested under
+//! @param[in] resource_type the type of the resources in the collection
+//! @param[in] content_type the resource type of the payloads when POSTed
+//! @param[in] apistr the media type of the collection
+//! @param[in] key the field that tells resources apart, or NULL to compare all the fields of the payloads
+//! @param[in] payloads the JSON payloads of the resources the collection is to hold, without the tenant
+//! @param[in] max_payloads number of payloads
+//!
+//! @return 0 on success or 1 if the collection could not be read or any of the changes failed
+//!
+int mido_sync_resources(midoname * parent, char *resource_type, char *content_type, char *apistr, char *key, char **payloads, int max_payloads)
+{
+    int rc = 0, ret = 0, i = 0, j = 0, max_names = 0, max_creates = 0, max_deletes = 0;
+    char url[EUCA_MAX_PATH], *payload = NULL, *val = NULL;
+    char **create_urls = NULL, **create_payloads = NULL, **delete_urls = NULL;
+    int *matched = NULL;
+    midoname *names = NULL;
+    json_object **want = NULL, **have = NULL, *el = NULL;
+
+    if (!parent || !parent->init || !resource_type || (!payloads && (max_payloads > 0))) {
+        return (1);
+    }
+
+    // what MidoNet holds now
+    mido_resources_url(parent, 1, parent->tenant, resource_type, url);
+    if (midonet_http_get(url, apistr, &payload)) {
+        LOGERROR("could not read %s of %s: check midonet health\n", resource_type, SP(parent->uuid));
+        return (1);
+    }
+    mido_resources_parse(payload, parent->tenant, resource_type, &names, &max_names);
+    EUCA_FREE(payload);
+
+    want = EUCA_ZALLOC(max_payloads + 1, sizeof(json_object *));
+    have = EUCA_ZALLOC(max_names + 1, sizeof(json_object *));
+    matched = EUCA_ZALLOC(max_names + 1, sizeof(int));
+    create_urls = EUCA_ZALLOC(max_payloads + 1, sizeof(char *));
+    create_payloads = EUCA_ZALLOC(max_payloads + 1, sizeof(char *));
+    delete_urls = EUCA_ZALLOC(max_names + 1, sizeof(char *));
+    if (!want || !have || !matched || !create_urls || !create_payloads || !delete_urls) {
+        LOGERROR("out of memory\n");
+        ret = 1;
+        goto done;
+    }
+
+    for (j = 0; j < max_names; j++) {
+        if ((have[j] = json_tokener_parse(names[j].jsonbuf)) && !strcmp(resource_type, "rules")) {
+            json_object_object_del(have[j], "position");
+        }
+    }
+
+    // pair each resource wanted with one held, by its key field or else by all its fields
+    for (i = 0; i < max_payloads; i++) {
+        if ((want[i] = json_tokener_parse(payloads[i])) == NULL) {
+            LOGERROR("invalid payload for %s of %s: %s\n", resource_type, SP(parent->uuid), SP(payloads[i]));
+            ret = 1;
+            continue;
+        }
+
+        val = NULL;
+        if (key && (el = json_object_object_get(want[i], key))) {
+            val = (char *)json_object_get_string(el);
+        }
+        for (j = 0; j < max_names; j++) {
+            if (matched[j] || !have[j]) {
+                continue;
+            }
+            if (val) {
+                el = json_object_object_get(have[j], key);
+                rc = (!el || strcmp(val, SP(json_object_get_string(el))));
+            } else {
+                rc = json_object_cmp(want[i], have[j]);
+            }
+            if (!rc) {
+                matched[j] = 1;
+                break;
+            }
+        }
+
+        if (j == max_names) {
+            if (parent->tenant) {
+                json_object_object_add(want[i], "tenantId", json_object_new_string(parent->tenant));
+            }
+            snprintf(url, EUCA_MAX_PATH, "http://localhost:8080/midonet-api/%s/%s/%s", parent->resource_type, parent->uuid, resource_type);
+            create_urls[max_creates] = strdup(url);
+            create_payloads[max_creates] = strdup(json_object_to_json_string(want[i]));
+            max_creates++;
+        }
+    }
+
+    for (j = 0; j < max_names; j++) {
+        if (!matched[j]) {
+            mido_resource_url(parent, &(names[j]), url);
+            delete_urls[max_deletes++] = strdup(url);
+        }
+    }
+
+    LOGDEBUG("%s of %s: %d in place, %d to create, %d to delete\n", resource_type, SP(parent->uuid), (max_names - max_deletes), max_creates, max_deletes);
+
+    // deletes go first, so that a resource being replaced never shows up twice
+    if (max_deletes && midonet_http_delete_multi(delete_urls, max_deletes)) {
+        LOGERROR("could not delete some %s of %s: check midonet health\n", resource_type, SP(parent->uuid));
+        ret = 1;
+    }
+    if (max_creates && midonet_http_post_multi(create_urls, max_creates, content_type, create_payloads, NULL)) {
+        LOGERROR("could not create some %s of %s: check midonet health\n", resource_type, SP(parent->uuid));
+        ret = 1;
+    }
+
+done:
+    for (i = 0; want && (i < max_payloads); i++) {
+        if (want[i])
+            json_object_put(want[i]);
+    }
+    for (j = 0; have && (j < max_names); j++) {
+        if (have[j])
+            json_object_put(have[j]);
+    }
+    for (i = 0; i < max_creates; i++) {
+        EUCA_FREE(create_urls[i]);
+        EUCA_FREE(create_payloads[i]);
+    }
+    for (j = 0; j < max_deletes; j++) {
+        EUCA_FREE(delete_urls[j]);
+    }
+    EUCA_FREE(want);
+    EUCA_FREE(have);
+    EUCA_FREE(matched);
+    EUCA_FREE(create_urls);
+    EUCA_FREE(create_payloads);
+    EUCA_FREE(delete_urls);
+    mido_free_midoname_list(names, max_names);
     EUCA_FREE(names);
+    return (ret);
+}
 
+//!
+//! Syncs the rules of a chain with a list of rule payloads, see mido_sync_resources(). The
+//! payloads must not carry a position, the order of the rules in the chain is not kept.
+//!
+//! @param[in] chain the chain to sync
+//! @param[in] rules the JSON payloads of the rules, as built by mido_jsonize_args()
+//! @param[in] max_rules number of rules
+//!
+//! @return 0 on success or 1 on failure
+//!
+int mido_sync_rules(midoname * chain, char **rules, int max_rules)
+{
+    return (mido_sync_resources(chain, "rules", "Rule", "application/vnd.org.midonet.collection.Rule-v2+json", NULL, rules, max_rules));
+}
+
+//!
+//! Syncs the addresses of an IP address group with a list of IPv4 addresses, see mido_sync_resources().
+//!
+//! @param[in] ipaddrgroup the IP address group to sync
+//! @param[in] ips the addresses in dot notation
+//! @param[in] max_ips number of addresses
+//!
+//! @return 0 on success or 1 on failure
+//!
+int mido_sync_ipaddrgroup_ips(midoname * ipaddrgroup, char **ips, int max_ips)
+{
+    int ret = 0, i = 0;
+    char **payloads = NULL;
+
+    if (max_ips > 0) {
+        payloads = EUCA_ZALLOC(max_ips, sizeof(char *));
+        if (!payloads) {
+            LOGERROR("out of memory\n");
+            return (1);
+        }
+    }
+    for (i = 0; i < max_ips; i++) {
+        payloads[i] = mido_jsonize_args(NULL, "addr", ips[i], "version", "4", NULL);
+    }
+
+    ret = mido_sync_resources(ipaddrgroup, "ip_addrs", "IpAddrGroupAddr", "application/vnd.org.midonet.collection.IpAddrGroupAddr-v1+json", "addr", payloads, max_ips);
+
+    for (i = 0; i < max_ips; i++) {
+        EUCA_FREE(payloads[i]);
+    }
+    EUCA_FREE(payloads);
     return (ret);
 }
 
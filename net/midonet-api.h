@@ -61,6 +61,7 @@ int mido_update_port(midoname * name, ...);
 int mido_print_port(midoname * name);
 int mido_delete_port(midoname * name);
 int mido_get_ports(midoname * devname, midoname ** outnames, int *outnames_max);
+int mido_get_ports_all(midoname * devnames, int max_devnames, midoname ** outnames, int *outnames_max);
 
 int mido_link_ports(midoname * a, midoname * b);
 
@@ -84,6 +85,7 @@ int mido_update_rule(midoname * name, ...);
 int mido_print_rule(midoname * name);
 int mido_delete_rule(midoname * name);
 int mido_get_rules(midoname * chainname, midoname ** outnames, int *outnames_max);
+int mido_sync_rules(midoname * chain, char **rules, int max_rules);
 
 int mido_create_ipaddrgroup(char *tenant, char *name, midoname * outname);
 //int mido_read_ipaddrgroup(midoname * name);
@@ -95,6 +97,7 @@ int mido_get_ipaddrgroups(char *tenant, midoname ** outnames, int *outnames_max)
 int mido_create_ipaddrgroup_ip(midoname * ipaddrgroup, char *ip, midoname * outname);
 int mido_delete_ipaddrgroup_ip(midoname * ipaddrgroup, midoname * ipaddrgroup_ip);
 int mido_get_ipaddrgroup_ips(midoname * ipaddrgroup, midoname ** outnames, int *outnames_max);
+int mido_sync_ipaddrgroup_ips(midoname * ipaddrgroup, char **ips, int max_ips);
 
 int mido_create_resource_v(midoname * parents, int max_parents, midoname * newname, midoname * outname, va_list * al);
 int mido_create_resource(midoname * parents, int max_parents, midoname * newname, midoname * outname, ...);
@@ -103,16 +106,22 @@ int mido_update_resource(char *resource_type, char *content_type, midoname * nam
 int mido_print_resource(char *resource_type, midoname * name);
 int mido_delete_resource(midoname * parentname, midoname * name);
 int mido_get_resources(midoname * parents, int max_parents, char *tenant, char *resource_type, char *apistr, midoname ** outnames, int *outnames_max);
+int mido_get_resources_all(midoname * devices, int max_devices, char *resource_type, char *apistr, midoname ** outnames, int *outnames_max);
+int mido_sync_resources(midoname * parent, char *resource_type, char *content_type, char *apistr, char *key, char **payloads, int max_payloads);
 //int mido_get_resources(midoname * parents, int max_parents, char *tenant, char *resource_type, midoname ** outnames, int *outnames_max);
 
 int mido_cmp_midoname_to_input(midoname * name, ...);
 int mido_cmp_midoname_to_input_json(midoname * name, ...);
 int mido_cmp_midoname_to_input_json_v(midoname * name, va_list * al);
 char *mido_jsonize(char *tenant, va_list * al);
+char *mido_jsonize_args(char *tenant, ...);
 
 int midonet_http_get(char *url, char *apistr, char **out_payload);
 int midonet_http_put(char *url, char *resource_type, char *payload);
 int midonet_http_post(char *url, char *resource_type, char *payload, char **out_payload);
 int midonet_http_delete(char *url);
+int midonet_http_get_multi(char **urls, int max_urls, char *apistr, char **out_payloads);
+int midonet_http_post_multi(char **urls, int max_urls, char *resource_type, char **payloads, char **out_locations);
+int midonet_http_delete_multi(char **urls, int max_urls);
 
 #endif
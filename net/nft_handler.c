@@ -0,0 +1,1741 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file net/nft_handler.c
+//! Renders the rules and sets of the ipt_handler, ips_handler and ebt_handler models as one
+//! nftables ruleset and applies it with a single 'nft -f', which the kernel commits as one
+//! netlink transaction: the filter, NAT and bridge rules change together or not at all.
+//!
+//! Only what eucanetd owns is rendered: the EUCA_* and EU_* chains, the jumps to them from the
+//! built-in chains and the sets those reference. These go to tables of their own (euca_filter,
+//! euca_nat, ... in the ip and bridge families), which every apply replaces as a whole. The
+//! built-in chains become base chains on the same hooks and priorities as their iptables and
+//! ebtables counterparts, with an accept policy: whatever policy the host firewall has stays
+//! with the host firewall.
+//!
+//! The ipsets become interval sets. Runs of rules that only differ in the exact address or
+//! interface they match become a single lookup:
+//! \li a run of rules each handing one address or interface a verdict becomes a verdict map
+//! \li a run of DNAT or SNAT rules, one per address, becomes a 'dnat/snat to ... map'
+//! \li a run of rules on a handful of interfaces each (e.g. the per-instance L2 isolation rules)
+//!     becomes a verdict map jumping to one chain per interface
+//! \li the jumps to the sec. group chains, one per group set, become a verdict map on the
+//!     destination address that jumps to the group chains of each instance
+//!
+//! The handlers keep their models between updates in this mode: nothing reads them back from
+//! the system.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <eucalyptus.h>
+#include <log.h>
+#include <vnetwork.h>
+#include <euca_string.h>
+
+#include "ipt_handler.h"
+#include "nft_handler.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define NFT_OWNED_PREFIX                     "EU"   //!< the chains and sets eucanetd owns: EUCA_* and the EU_<hash> of the sec. groups
+#define NFT_MAX_TERMS                        32 //!< most matches a rule may have
+#define NFT_MAX_MATCH_LEN                    1024
+#define NFT_MIN_MAP_RUN                      4  //!< how many consecutive rules on distinct keys it takes to turn them into a map
+#define NFT_MIN_DISPATCH_RUN                 2  //!< how many consecutive jumps to sec. group chains it takes to turn them into a verdict map
+#define NFT_ELEMENTS_PER_LINE                16
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! What the statement of a translated rule is, as far as turning runs of rules into maps goes
+enum { NFT_STMT_OTHER, NFT_STMT_VERDICT, NFT_STMT_DNAT, NFT_STMT_SNAT };
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Where a built-in chain hooks in, in nftables terms
+typedef struct nft_hook_t {
+    const char *family;
+    const char *table;
+    const char *chain;
+    const char *hook;
+    const char *type;
+    int priority;
+} nft_hook;
+
+//! A rule translated to nftables, taken apart for the map building
+typedef struct nft_rule_t {
+    char match[NFT_MAX_MATCH_LEN];     //!< the matches of the rule, but for its key
+    char keytype[16];                  //!< what the key matches, e.g. 'ip daddr' or 'iifname', empty when the rule has no key
+    char key[64];                      //!< the exact address or (quoted) interface name of the key
+    char dstset[64];                   //!< the set of a rule that only matches the destination against a set
+    char stmt[320];                    //!< what the rule does
+    char natto[64];                    //!< the address of a 'dnat to' or 'snat to'
+    int kind;                          //!< one of NFT_STMT_*
+} nft_rule;
+
+//! The matches of a rule being translated, one of which may become its key
+typedef struct nft_terms_t {
+    char term[NFT_MAX_TERMS][256];
+    char keytype[NFT_MAX_TERMS][16];   //!< what an exact match can serve as a key for, empty if it can not
+    char key[NFT_MAX_TERMS][64];
+    int max_terms;
+} nft_terms;
+
+//! What gets written for one table: its declarations and, apart, its rules
+typedef struct nft_out_t {
+    const char *family;
+    const char *table;                 //!< the iptables or ebtables name of the table
+    FILE *rules;                       //!< the 'add rule' lines, which go after all declarations
+    char *rulesbuf;
+    size_t ruleslen;
+    FILE *chains;                      //!< the chain declarations
+    char *chainsbuf;
+    size_t chainslen;
+    char **sets;                       //!< the sets the rules reference, by their ipset names
+    int max_sets;
+    int generated;                     //!< how many chains the maps have jump to so far
+} nft_out;
+
+//! An address some sec. group dispatch rule applies to
+typedef struct nft_dispatch_t {
+    u32 ip;
+    int rule;                          //!< the position of the rule in its run
+} nft_dispatch;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! The built-in chains of iptables and ebtables, at the priorities of their tables
+static const nft_hook nft_hooks[] = {
+    {"ip", "raw", "PREROUTING", "prerouting", "filter", -300},
+    {"ip", "raw", "OUTPUT", "output", "filter", -300},
+    {"ip", "mangle", "PREROUTING", "prerouting", "filter", -150},
+    {"ip", "mangle", "INPUT", "input", "filter", -150},
+    {"ip", "mangle", "FORWARD", "forward", "filter", -150},
+    {"ip", "mangle", "OUTPUT", "output", "route", -150},
+    {"ip", "mangle", "POSTROUTING", "postrouting", "filter", -150},
+    {"ip", "nat", "PREROUTING", "prerouting", "nat", -100},
+    {"ip", "nat", "INPUT", "input", "nat", 100},
+    {"ip", "nat", "OUTPUT", "output", "nat", -100},
+    {"ip", "nat", "POSTROUTING", "postrouting", "nat", 100},
+    {"ip", "filter", "INPUT", "input", "filter", 0},
+    {"ip", "filter", "FORWARD", "forward", "filter", 0},
+    {"ip", "filter", "OUTPUT", "output", "filter", 0},
+    {"bridge", "filter", "INPUT", "input", "filter", -200},
+    {"bridge", "filter", "FORWARD", "forward", "filter", -200},
+    {"bridge", "filter", "OUTPUT", "output", "filter", -200},
+    {"bridge", "nat", "PREROUTING", "prerouting", "filter", -300},
+    {"bridge", "nat", "OUTPUT", "output", "filter", 100},
+    {"bridge", "nat", "POSTROUTING", "postrouting", "filter", 300},
+    {NULL, NULL, NULL, NULL, NULL, 0},
+};
+
+//! The ARP operations ebtables knows, with their nftables names and values
+static const struct {
+    const char *ebt;
+    const char *nft;
+    int op;
+} nft_arp_ops[] = {
+    {"Request", "request", 1}, {"Reply", "reply", 2}, {"Request_Reverse", "rrequest", 3}, {"Reply_Reverse", "rreply", 4},
+    {"InARP_Request", "inrequest", 8}, {"InARP_Reply", "inreply", 9}, {"ARP_NAK", "nak", 10}, {NULL, NULL, 0},
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static const nft_hook *nft_find_hook(const char *family, const char *table, const char *chain);
+static int nft_is_owned(const char *name);
+static void nft_name(const char *name, char *out, int len);
+static void nft_ipstr(u32 ip, char *out, int len);
+static int nft_out_use_set(nft_out * out, ips_handler * ipsh, const char *setname);
+static void nft_terms_add(nft_terms * terms, const char *keytype, const char *key, const char *format, ...) _attribute_format_(4, 5);
+static void nft_terms_finish(nft_terms * terms, const char **keyorder, nft_rule * rule);
+static void nft_portrange(const char *in, char *out, int len);
+static int nft_mac(const char *in, char *out, int len, boolean raw);
+static int nft_mark(const char *in, boolean set, char *out, int len);
+static int nft_ipt_translate(const char *iptrule, ipt_table * table, ips_handler * ipsh, nft_out * out, nft_rule * rule);
+static int nft_ebt_translate(const char *ebtrule, ebt_table * table, nft_rule * rule);
+static int nft_ordercmp(const void *p1, const void *p2);
+static int nft_keycmp(const void *p1, const void *p2);
+static int nft_dispatchcmp(const void *p1, const void *p2);
+static void nft_write_rule(nft_out * out, const char *chain, const char *match, const char *stmt);
+static void nft_begin_rule(nft_out * out, const char *chain, const char *match);
+static int nft_write_dispatch(nft_out * out, const char *chain, nft_rule * rules, int max_rules, ips_handler * ipsh);
+static int nft_write_keyed(nft_out * out, const char *chain, nft_rule * rules, int max_rules);
+static void nft_write_rules(nft_out * out, const char *chain, nft_rule * rules, int max_rules, ips_handler * ipsh);
+static void nft_declare_chain(nft_out * out, const char *chain, const nft_hook * hook);
+static int nft_render_ipt_table(ipt_table * table, ips_handler * ipsh, nft_out * out);
+static int nft_render_ebt_table(ebt_table * table, nft_out * out);
+static void nft_write_sets(FILE * FH, nft_out * out, ips_handler * ipsh);
+static int nft_write_table(FILE * FH, nft_out * out, ips_handler * ipsh);
+static int nft_out_init(nft_out * out, const char *family, const char *table);
+static void nft_out_free(nft_out * out);
+static void nft_write_preamble(FILE * FH);
+static int nft_system_restore(nft_handler * nfth);
+static unsigned long long nft_hash(const char *buf, size_t len);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! What goes before the element _n of a set or map, to keep the lines of long ones short
+#define NFT_ELEMENT_SEP(_n)                      (((_n) == 0) ? "" : ((((_n) % NFT_ELEMENTS_PER_LINE) == 0) ? ",\n\t" : ", "))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Initializes the nftables handler and checks that nft can be run
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//! @param[in] cmdprefix what to run nft with, e.g. the rootwrap (may be NULL)
+//!
+//! @return 0 on success or 1 on failure
+//!
+int nft_handler_init(nft_handler * nfth, char *cmdprefix)
+{
+    int fd;
+    char cmd[EUCA_MAX_PATH];
+
+    if (!nfth) {
+        return (1);
+    }
+    bzero(nfth, sizeof(nft_handler));
+
+    snprintf(nfth->nft_file, EUCA_MAX_PATH, "/tmp/nft_file-XXXXXX");
+    fd = safe_mkstemp(nfth->nft_file);
+    if (fd < 0) {
+        LOGERROR("cannot create tmpfile '%s': check permissions\n", nfth->nft_file);
+        return (1);
+    }
+    if (chmod(nfth->nft_file, 0600)) {
+        LOGWARN("chmod failed: was able to create tmpfile '%s', but could not change file permissions\n", nfth->nft_file);
+    }
+    close(fd);
+
+    if (cmdprefix) {
+        snprintf(nfth->cmdprefix, EUCA_MAX_PATH, "%s", cmdprefix);
+    } else {
+        nfth->cmdprefix[0] = '\0';
+    }
+
+    // test required shell-outs
+    snprintf(cmd, EUCA_MAX_PATH, "%s nft list tables >/dev/null 2>&1", nfth->cmdprefix);
+    if (system(cmd)) {
+        LOGERROR("could not execute required shell out '%s': check command/permissions\n", cmd);
+        return (1);
+    }
+
+    nfth->init = 1;
+    return (0);
+}
+
+//!
+//! Releases the nftables handler. The applied ruleset stays in place.
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+int nft_handler_free(nft_handler * nfth)
+{
+    if (!nfth || !nfth->init) {
+        return (1);
+    }
+    unlink(nfth->nft_file);
+    nfth->init = 0;
+    return (0);
+}
+
+//!
+//! Sets the models up with the built-in tables and chains, which, in this mode, nothing reads
+//! back from the system: the update functions add their jumps to them.
+//!
+//! @param[in] ipth pointer to the IP table handler structure
+//! @param[in] ebth pointer to the EB table handler structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+int nft_handler_prepare(ipt_handler * ipth, ebt_handler * ebth)
+{
+    int i = 0;
+    int rc = 0;
+
+    if (!ipth || !ebth || !ipth->init || !ebth->init) {
+        return (1);
+    }
+
+    for (i = 0; nft_hooks[i].family; i++) {
+        if (!strcmp(nft_hooks[i].family, "ip")) {
+            rc |= ((ipt_handler_add_table(ipth, (char *)nft_hooks[i].table) != 0)
+                   || (ipt_table_add_chain(ipth, (char *)nft_hooks[i].table, (char *)nft_hooks[i].chain, "ACCEPT", "[0:0]") != 0));
+        } else {
+            rc |= ((ebt_handler_add_table(ebth, (char *)nft_hooks[i].table) != 0)
+                   || (ebt_table_add_chain(ebth, (char *)nft_hooks[i].table, (char *)nft_hooks[i].chain, "ACCEPT", "") != 0));
+        }
+    }
+    return (rc ? 1 : 0);
+}
+
+//!
+//! Looks up where a built-in chain hooks in
+//!
+//! @param[in] family 'ip' or 'bridge'
+//! @param[in] table the iptables or ebtables table name
+//! @param[in] chain the chain name, or NULL for any hook of the table
+//!
+//! @return the hook or NULL if the chain is not a built-in one
+//!
+static const nft_hook *nft_find_hook(const char *family, const char *table, const char *chain)
+{
+    int i = 0;
+
+    for (i = 0; nft_hooks[i].family; i++) {
+        if (!strcmp(nft_hooks[i].family, family) && !strcmp(nft_hooks[i].table, table) && (!chain || !strcmp(nft_hooks[i].chain, chain))) {
+            return (&(nft_hooks[i]));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! @param[in] name a chain or set name
+//!
+//! @return 1 if eucanetd owns the chain or set, 0 otherwise
+//!
+static int nft_is_owned(const char *name)
+{
+    return ((strncmp(name, NFT_OWNED_PREFIX, strlen(NFT_OWNED_PREFIX))) ? 0 : 1);
+}
+
+//!
+//! Spells a chain or set name the way nft takes it as a bare word. The hashed sec. group names
+//! are base64, so anything but letters, digits and '_' is written as '.' and its hex code.
+//!
+//! @param[in]  name the iptables, ebtables or ipset name
+//! @param[out] out where to write the nft name
+//! @param[in]  len size of out
+//!
+static void nft_name(const char *name, char *out, int len)
+{
+    int i = 0;
+
+    for (; *name && (i < (len - 4)); name++) {
+        if (isalnum((unsigned char)*name) || (*name == '_')) {
+            out[i++] = *name;
+        } else {
+            i += snprintf(out + i, (len - i), ".%02X", (unsigned char)*name);
+        }
+    }
+    out[i] = '\0';
+}
+
+//!
+//! @param[in]  ip an address in host byte order
+//! @param[out] out where to write its dotted quad
+//! @param[in]  len size of out
+//!
+static void nft_ipstr(u32 ip, char *out, int len)
+{
+    snprintf(out, len, "%u.%u.%u.%u", ((ip >> 24) & 0xFF), ((ip >> 16) & 0xFF), ((ip >> 8) & 0xFF), (ip & 0xFF));
+}
+
+//!
+//! Records that the rules of a table reference a set, which then gets declared in the table
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] setname the ipset name of the set
+//!
+//! @return 0 on success or 1 if there is no such set
+//!
+static int nft_out_use_set(nft_out * out, ips_handler * ipsh, const char *setname)
+{
+    int i = 0;
+
+    if (!ips_handler_find_set(ipsh, (char *)setname)) {
+        LOGERROR("rule references set %s, which does not exist\n", setname);
+        return (1);
+    }
+
+    for (i = 0; i < out->max_sets; i++) {
+        if (!strcmp(out->sets[i], setname)) {
+            return (0);
+        }
+    }
+
+    out->sets = EUCA_REALLOC(out->sets, (out->max_sets + 1), sizeof(char *));
+    if (!out->sets || !(out->sets[out->max_sets] = strdup(setname))) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+    out->max_sets++;
+    return (0);
+}
+
+//!
+//! Adds a match to a rule being translated
+//!
+//! @param[in] terms the matches of the rule so far
+//! @param[in] keytype what the match can be the key of a map on, or NULL if it is not an exact match
+//! @param[in] key the address or interface the exact match is on
+//! @param[in] format printf() format of the match
+//! @param[in] ...
+//!
+static void nft_terms_add(nft_terms * terms, const char *keytype, const char *key, const char *format, ...)
+{
+    va_list ap;
+
+    if (terms->max_terms >= NFT_MAX_TERMS) {
+        return;
+    }
+
+    va_start(ap, format);
+    vsnprintf(terms->term[terms->max_terms], sizeof(terms->term[0]), format, ap);
+    va_end(ap);
+    snprintf(terms->keytype[terms->max_terms], sizeof(terms->keytype[0]), "%s", ((keytype) ? keytype : ""));
+    snprintf(terms->key[terms->max_terms], sizeof(terms->key[0]), "%s", ((key) ? key : ""));
+    terms->max_terms++;
+}
+
+//!
+//! Picks the key of a translated rule and joins its other matches
+//!
+//! @param[in]  terms the matches of the rule
+//! @param[in]  keyorder what may serve as the key, by preference, NULL-terminated
+//! @param[out] rule gets the key and the matches
+//!
+static void nft_terms_finish(nft_terms * terms, const char **keyorder, nft_rule * rule)
+{
+    int i = 0;
+    int k = 0;
+    int keyterm = -1;
+    size_t len = 0;
+
+    for (k = 0; keyorder[k] && (keyterm < 0); k++) {
+        for (i = 0; (i < terms->max_terms) && (keyterm < 0); i++) {
+            if (!strcmp(terms->keytype[i], keyorder[k])) {
+                keyterm = i;
+            }
+        }
+    }
+
+    rule->match[0] = rule->keytype[0] = rule->key[0] = '\0';
+    if (keyterm >= 0) {
+        euca_strncpy(rule->keytype, terms->keytype[keyterm], sizeof(rule->keytype));
+        euca_strncpy(rule->key, terms->key[keyterm], sizeof(rule->key));
+    }
+
+    for (i = 0; i < terms->max_terms; i++) {
+        if ((i != keyterm) && (len < sizeof(rule->match))) {
+            len += snprintf(rule->match + len, (sizeof(rule->match) - len), "%s%s", ((len) ? " " : ""), terms->term[i]);
+        }
+    }
+}
+
+//!
+//! @param[in]  in a port or an iptables port range 'low:high'
+//! @param[out] out the port or nft port range 'low-high'
+//! @param[in]  len size of out
+//!
+static void nft_portrange(const char *in, char *out, int len)
+{
+    char *ptr = NULL;
+
+    euca_strncpy(out, in, len);
+    if ((ptr = strchr(out, ':')) != NULL) {
+        *ptr = '-';
+    }
+}
+
+//!
+//! Normalizes a MAC address, or the ebtables names of the broadcast and multicast ones
+//!
+//! @param[in]  in the MAC address as ebtables takes it
+//! @param[out] out the colon separated address or, with raw, its 48 bit value in hex
+//! @param[in]  len size of out
+//! @param[in]  raw set to TRUE for the value in hex
+//!
+//! @return 0 on success or 1 if this is not a MAC address
+//!
+static int nft_mac(const char *in, char *out, int len, boolean raw)
+{
+    unsigned int b[6] = { 0 };
+    char tail = '\0';
+
+    if (!strcasecmp(in, "Broadcast")) {
+        in = "ff:ff:ff:ff:ff:ff";
+    }
+    if (sscanf(in, "%x:%x:%x:%x:%x:%x%c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &tail) != 6) {
+        return (1);
+    }
+    if ((b[0] | b[1] | b[2] | b[3] | b[4] | b[5]) > 0xFF) {
+        return (1);
+    }
+    snprintf(out, len, (raw ? "0x%02x%02x%02x%02x%02x%02x" : "%02x:%02x:%02x:%02x:%02x:%02x"), b[0], b[1], b[2], b[3], b[4], b[5]);
+    return (0);
+}
+
+//!
+//! Translates the firewall mark of a '--mark value[/mask]' match or a '--set-xmark value[/mask]'
+//! or '--set-mark value' target
+//!
+//! @param[in]  in the value and optional mask
+//! @param[in]  set set to TRUE for a target, FALSE for a match
+//! @param[out] out the nft expression, to follow 'meta mark' or 'meta mark set'
+//! @param[in]  len size of out
+//!
+//! @return 0 on success or 1 on a malformed mark
+//!
+static int nft_mark(const char *in, boolean set, char *out, int len)
+{
+    u32 value = 0;
+    u32 mask = 0xFFFFFFFF;
+    char *end = NULL;
+
+    value = strtoul(in, &end, 0);
+    if (*end == '/') {
+        mask = strtoul(end + 1, &end, 0);
+    }
+    if (*end != '\0') {
+        return (1);
+    }
+
+    if (mask == 0xFFFFFFFF) {
+        snprintf(out, len, "0x%08x", value);
+    } else if (set) {
+        // --set-xmark clears the bits of the mask and then flips those of the value
+        snprintf(out, len, "meta mark and 0x%08x xor 0x%08x", (~mask), value);
+    } else {
+        snprintf(out, len, "and 0x%08x 0x%08x", mask, value);
+    }
+    return (0);
+}
+
+//!
+//! Translates a rule of the IP table handler model. Only what eucanetd writes is understood:
+//! addresses, interfaces, protocols and ports, ICMP types, sets, connection states, marks and
+//! the ACCEPT, DROP, RETURN, REJECT, MARK, DNAT, SNAT and MASQUERADE targets, along with jumps to
+//! the chains eucanetd owns.
+//!
+//! @param[in]  iptrule the rule, as in '-A <chain> <matches> -j <target>'
+//! @param[in]  table the table of the rule
+//! @param[in]  ipsh pointer to the IP set handler structure
+//! @param[in]  out what is being written for the table, to record the sets the rule references
+//! @param[out] rule the translation
+//!
+//! @return 0 on success or 1 if the rule can not be translated
+//!
+static int nft_ipt_translate(const char *iptrule, ipt_table * table, ips_handler * ipsh, nft_out * out, nft_rule * rule)
+{
+    int i = 0;
+    boolean neg = FALSE;
+    char buf[1024] = "";
+    char proto[32] = "";
+    char dport[64] = "";
+    char sport[64] = "";
+    char target[64] = "";
+    char markset[64] = "";
+    char natto[64] = "";
+    char name[256] = "";
+    char val[128] = "";
+    char *ptr = NULL;
+    char *tok = NULL;
+    char *arg = NULL;
+    char *arg2 = NULL;
+    ipt_chain *chain = NULL;
+    nft_terms terms = { {{0}}, {{0}}, {{0}}, 0 };
+    static const char *keyorder[] = { "ip daddr", "ip saddr", "iifname", "oifname", NULL };
+
+    bzero(rule, sizeof(nft_rule));
+    euca_strncpy(buf, iptrule, sizeof(buf));
+
+#define _NEXT()                       (arg = strtok_r(NULL, " ", &ptr))
+    for (tok = strtok_r(buf, " ", &ptr); tok; tok = strtok_r(NULL, " ", &ptr)) {
+        if (!strcmp(tok, "!")) {
+            neg = TRUE;
+            continue;
+        }
+
+        if (!strcmp(tok, "-A")) {
+            if (!_NEXT())
+                return (1);
+        } else if (!strcmp(tok, "-s") || !strcmp(tok, "-d")) {
+            if (!_NEXT() || (!strcmp(arg, "!") && (neg = TRUE) && !_NEXT()))
+                return (1);
+            euca_strncpy(val, arg, sizeof(val));
+            if ((strlen(val) > 3) && !strcmp(val + strlen(val) - 3, "/32"))
+                val[strlen(val) - 3] = '\0';
+            nft_terms_add(&terms, ((neg || strchr(val, '/')) ? NULL : ((tok[1] == 's') ? "ip saddr" : "ip daddr")), val, "ip %s %s%s", ((tok[1] == 's') ? "saddr" : "daddr"),
+                          (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "-i") || !strcmp(tok, "-o")) {
+            if (!_NEXT() || (!strcmp(arg, "!") && (neg = TRUE) && !_NEXT()))
+                return (1);
+            snprintf(val, sizeof(val), "\"%s\"", arg);
+            if ((i = strlen(val)) > 2 && (val[i - 2] == '+'))
+                val[i - 2] = '*';
+            nft_terms_add(&terms, ((neg || strchr(val, '*')) ? NULL : ((tok[1] == 'i') ? "iifname" : "oifname")), val, "%s %s%s", ((tok[1] == 'i') ? "iifname" : "oifname"),
+                          (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "-p")) {
+            if (neg || !_NEXT())
+                return (1);
+            euca_strncpy(proto, ((strcmp(arg, "all")) ? arg : ""), sizeof(proto));
+        } else if (!strcmp(tok, "-m")) {
+            // the match modules are implied by their options
+            if (!_NEXT() || !strcmp(arg, "comment"))
+                return (1);
+        } else if (!strcmp(tok, "--dport") || !strcmp(tok, "--sport") || !strcmp(tok, "--destination-port") || !strcmp(tok, "--source-port")) {
+            if (!_NEXT())
+                return (1);
+            snprintf(val, sizeof(val), "%s", (neg ? "!= " : ""));
+            nft_portrange(arg, val + strlen(val), (sizeof(val) - strlen(val)));
+            euca_strncpy(((tok[2] == 'd') ? dport : sport), val, sizeof(dport));
+        } else if (!strcmp(tok, "--icmp-type")) {
+            if (!_NEXT() || strchr(arg, '/'))
+                return (1);
+            if (strcmp(arg, "any"))
+                nft_terms_add(&terms, NULL, NULL, "icmp type %s%s", (neg ? "!= " : ""), arg);
+        } else if (!strcmp(tok, "--match-set") || !strcmp(tok, "--set")) {
+            if (!_NEXT() || !(arg2 = strtok_r(NULL, " ", &ptr)) || nft_out_use_set(out, ipsh, arg))
+                return (1);
+            nft_name(arg, name, sizeof(name));
+            // our sets are hash:net, which have one dimension: 'src,dst' only looks at the source
+            if (!strcmp(arg2, "dst")) {
+                nft_terms_add(&terms, NULL, NULL, "ip daddr %s@%s", (neg ? "!= " : ""), name);
+                if (!neg)
+                    euca_strncpy(rule->dstset, arg, sizeof(rule->dstset));
+            } else if (!strncmp(arg2, "src", 3)) {
+                nft_terms_add(&terms, NULL, NULL, "ip saddr %s@%s", (neg ? "!= " : ""), name);
+            } else {
+                return (1);
+            }
+        } else if (!strcmp(tok, "--ctstate") || !strcmp(tok, "--state")) {
+            if (!_NEXT() || (neg && strchr(arg, ',')))
+                return (1);
+            euca_strncpy(val, arg, sizeof(val));
+            for (i = 0; val[i]; i++)
+                val[i] = tolower((unsigned char)val[i]);
+            nft_terms_add(&terms, NULL, NULL, "ct state %s%s", (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "--mark")) {
+            if (!_NEXT() || nft_mark(arg, FALSE, val, sizeof(val)) || (neg && !strncmp(val, "and", 3)))
+                return (1);
+            nft_terms_add(&terms, NULL, NULL, "meta mark %s%s", (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "-j")) {
+            if (!_NEXT())
+                return (1);
+            euca_strncpy(target, arg, sizeof(target));
+        } else if (!strcmp(tok, "--set-xmark") || !strcmp(tok, "--set-mark")) {
+            if (!_NEXT() || nft_mark(arg, TRUE, markset, sizeof(markset)))
+                return (1);
+        } else if (!strcmp(tok, "--to-destination") || !strcmp(tok, "--to-source")) {
+            if (!_NEXT())
+                return (1);
+            euca_strncpy(natto, arg, sizeof(natto));
+        } else {
+            return (1);
+        }
+        neg = FALSE;
+    }
+#undef _NEXT
+
+    if (dport[0] || sport[0]) {
+        if (strcmp(proto, "tcp") && strcmp(proto, "udp") && strcmp(proto, "sctp") && strcmp(proto, "dccp") && strcmp(proto, "udplite"))
+            return (1);
+        if (sport[0])
+            nft_terms_add(&terms, NULL, NULL, "%s sport %s", proto, sport);
+        if (dport[0])
+            nft_terms_add(&terms, NULL, NULL, "%s dport %s", proto, dport);
+    } else if (proto[0]) {
+        nft_terms_add(&terms, NULL, NULL, "ip protocol %s", proto);
+    }
+    nft_terms_finish(&terms, keyorder, rule);
+
+    rule->kind = NFT_STMT_OTHER;
+    if (!target[0]) {
+        // a rule without a target is there for its counters
+        snprintf(rule->stmt, sizeof(rule->stmt), "counter");
+    } else if (!strcmp(target, "ACCEPT") || !strcmp(target, "DROP") || !strcmp(target, "RETURN")) {
+        for (i = 0; target[i]; i++)
+            rule->stmt[i] = tolower((unsigned char)target[i]);
+        rule->kind = NFT_STMT_VERDICT;
+    } else if (!strcmp(target, "REJECT") || !strcmp(target, "MASQUERADE")) {
+        for (i = 0; target[i]; i++)
+            rule->stmt[i] = tolower((unsigned char)target[i]);
+    } else if (!strcmp(target, "MARK") && markset[0]) {
+        snprintf(rule->stmt, sizeof(rule->stmt), "meta mark set %s", markset);
+    } else if ((!strcmp(target, "DNAT") || !strcmp(target, "SNAT")) && natto[0]) {
+        snprintf(rule->stmt, sizeof(rule->stmt), "%cnat to %s", tolower((unsigned char)target[0]), natto);
+        if (!strchr(natto, ':') && !strchr(natto, '-')) {
+            euca_strncpy(rule->natto, natto, sizeof(rule->natto));
+            rule->kind = ((target[0] == 'D') ? NFT_STMT_DNAT : NFT_STMT_SNAT);
+        }
+    } else if (nft_is_owned(target)) {
+        // jumps are only rendered to the chains that get declared: ours, live and in the same table
+        for (i = 0; (i < table->max_chains) && !chain; i++) {
+            if (!strcmp(table->chains[i].name, target) && !table->chains[i].flushed)
+                chain = &(table->chains[i]);
+        }
+        if (!chain) {
+            LOGERROR("rule '%s' jumps to chain %s, which is not there\n", iptrule, target);
+            return (1);
+        }
+        nft_name(target, name, sizeof(name));
+        snprintf(rule->stmt, sizeof(rule->stmt), "jump %s", name);
+        rule->kind = NFT_STMT_VERDICT;
+    } else {
+        return (1);
+    }
+    return (0);
+}
+
+//!
+//! Translates a rule of the EB table handler model: interfaces, MAC addresses, protocols, the
+//! IPv4 and ARP matches and the ACCEPT, DROP, RETURN and CONTINUE targets, along with jumps to
+//! the chains eucanetd owns. The ARP matches of other ethernet types (RARP) match the payload
+//! the way ebtables does, since nft only knows the layout of ARP itself.
+//!
+//! @param[in]  ebtrule the rule, as in '<matches> -j <target>'
+//! @param[in]  table the table of the rule
+//! @param[out] rule the translation
+//!
+//! @return 0 on success or 1 if the rule can not be translated
+//!
+static int nft_ebt_translate(const char *ebtrule, ebt_table * table, nft_rule * rule)
+{
+    int i = 0;
+    int op = 0;
+    boolean neg = FALSE;
+    boolean arp = FALSE;
+    char buf[1024] = "";
+    char proto[32] = "";
+    char target[64] = "";
+    char name[256] = "";
+    char val[128] = "";
+    char *ptr = NULL;
+    char *tok = NULL;
+    char *arg = NULL;
+    ebt_chain *chain = NULL;
+    nft_terms terms = { {{0}}, {{0}}, {{0}}, 0 };
+    static const char *keyorder[] = { "iifname", "oifname", NULL };
+
+    bzero(rule, sizeof(nft_rule));
+    euca_strncpy(buf, ebtrule, sizeof(buf));
+
+    // the ARP matches depend on the protocol, which may come after them
+    if (((tok = strstr(buf, "-p ")) != NULL) && ((tok == buf) || (tok[-1] == ' '))) {
+        arp = (!strncasecmp(tok + 3, "ARP ", 4) || !strcasecmp(tok + 3, "ARP") || !strncasecmp(tok + 3, "0x0806", 6));
+    }
+
+#define _NEXT()                       (arg = strtok_r(NULL, " ", &ptr))
+#define _ARG()                        (_NEXT() && (strcmp(arg, "!") || ((neg = TRUE) && _NEXT())))
+    for (tok = strtok_r(buf, " ", &ptr); tok; tok = strtok_r(NULL, " ", &ptr)) {
+        if (!strcmp(tok, "!")) {
+            neg = TRUE;
+            continue;
+        }
+
+        if (!strcmp(tok, "-i") || !strcmp(tok, "-o") || !strcmp(tok, "--in-interface") || !strcmp(tok, "--out-interface")) {
+            if (!_ARG())
+                return (1);
+            snprintf(val, sizeof(val), "\"%s\"", arg);
+            if ((i = strlen(val)) > 2 && (val[i - 2] == '+'))
+                val[i - 2] = '*';
+            snprintf(name, sizeof(name), "%s", ((tok[1] == 'i' || tok[2] == 'i') ? "iifname" : "oifname"));
+            nft_terms_add(&terms, ((neg || strchr(val, '*')) ? NULL : name), val, "%s %s%s", name, (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "-s") || !strcmp(tok, "-d")) {
+            if (!_ARG() || nft_mac(arg, val, sizeof(val), FALSE))
+                return (1);
+            nft_terms_add(&terms, NULL, NULL, "ether %s %s%s", ((tok[1] == 's') ? "saddr" : "daddr"), (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "-p")) {
+            if (!_ARG())
+                return (1);
+            if (!strcasecmp(arg, "IPv4") || !strcasecmp(arg, "0x0800")) {
+                snprintf(proto, sizeof(proto), "ip");
+            } else if (!strcasecmp(arg, "ARP") || !strcasecmp(arg, "0x0806")) {
+                snprintf(proto, sizeof(proto), "arp");
+            } else if (!strcasecmp(arg, "IPv6") || !strcasecmp(arg, "0x86dd")) {
+                snprintf(proto, sizeof(proto), "ip6");
+            } else if (!strncasecmp(arg, "0x", 2) && (strspn(arg + 2, "0123456789abcdefABCDEF") == strlen(arg + 2))) {
+                snprintf(proto, sizeof(proto), "0x%04lx", strtoul(arg, NULL, 16));
+            } else {
+                return (1);
+            }
+            nft_terms_add(&terms, NULL, NULL, "ether type %s%s", (neg ? "!= " : ""), proto);
+        } else if (!strcmp(tok, "--ip-proto") || !strcmp(tok, "--ip-protocol")) {
+            if (!_ARG())
+                return (1);
+            euca_strncpy(proto, arg, sizeof(proto));
+            nft_terms_add(&terms, NULL, NULL, "ip protocol %s%s", (neg ? "!= " : ""), arg);
+        } else if (!strcmp(tok, "--ip-src") || !strcmp(tok, "--ip-dst") || !strcmp(tok, "--ip-source") || !strcmp(tok, "--ip-destination")) {
+            if (!_ARG())
+                return (1);
+            nft_terms_add(&terms, NULL, NULL, "ip %s %s%s", ((tok[5] == 's') ? "saddr" : "daddr"), (neg ? "!= " : ""), arg);
+        } else if (!strcmp(tok, "--ip-sport") || !strcmp(tok, "--ip-dport") || !strcmp(tok, "--ip-source-port") || !strcmp(tok, "--ip-destination-port")) {
+            if (!_ARG() || (strcmp(proto, "tcp") && strcmp(proto, "udp") && strcmp(proto, "sctp") && strcmp(proto, "dccp")))
+                return (1);
+            nft_portrange(arg, val, sizeof(val));
+            nft_terms_add(&terms, NULL, NULL, "%s %s %s%s", proto, ((tok[5] == 's') ? "sport" : "dport"), (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "--arp-op") || !strcmp(tok, "--arp-opcode")) {
+            if (!_ARG())
+                return (1);
+            for (i = 0, op = 0; nft_arp_ops[i].ebt && !op; i++) {
+                if (!strcasecmp(arg, nft_arp_ops[i].ebt))
+                    op = i + 1;
+            }
+            if (!op)
+                return (1);
+            if (arp)
+                nft_terms_add(&terms, NULL, NULL, "arp operation %s%s", (neg ? "!= " : ""), nft_arp_ops[op - 1].nft);
+            else
+                nft_terms_add(&terms, NULL, NULL, "@nh,48,16 %s%d", (neg ? "!= " : ""), nft_arp_ops[op - 1].op);
+        } else if (!strcmp(tok, "--arp-ip-src") || !strcmp(tok, "--arp-ip-dst")) {
+            if (!_ARG() || strchr(arg, '/'))
+                return (1);
+            if (arp) {
+                nft_terms_add(&terms, NULL, NULL, "arp %s ip %s%s", ((tok[9] == 's') ? "saddr" : "daddr"), (neg ? "!= " : ""), arg);
+            } else {
+                snprintf(val, sizeof(val), "0x%08x", dot2hex(arg));
+                nft_terms_add(&terms, NULL, NULL, "@nh,%d,32 %s%s", ((tok[9] == 's') ? 112 : 192), (neg ? "!= " : ""), val);
+            }
+        } else if (!strcmp(tok, "--arp-mac-src") || !strcmp(tok, "--arp-mac-dst")) {
+            if (!_ARG() || nft_mac(arg, val, sizeof(val), !arp))
+                return (1);
+            if (arp)
+                nft_terms_add(&terms, NULL, NULL, "arp %s ether %s%s", ((tok[10] == 's') ? "saddr" : "daddr"), (neg ? "!= " : ""), val);
+            else
+                nft_terms_add(&terms, NULL, NULL, "@nh,%d,48 %s%s", ((tok[10] == 's') ? 64 : 144), (neg ? "!= " : ""), val);
+        } else if (!strcmp(tok, "-j") || !strcmp(tok, "--jump")) {
+            if (neg || !_NEXT())
+                return (1);
+            euca_strncpy(target, arg, sizeof(target));
+        } else {
+            return (1);
+        }
+        neg = FALSE;
+    }
+#undef _ARG
+#undef _NEXT
+
+    nft_terms_finish(&terms, keyorder, rule);
+
+    rule->kind = NFT_STMT_VERDICT;
+    if (!strcmp(target, "ACCEPT") || !strcmp(target, "DROP") || !strcmp(target, "RETURN")) {
+        for (i = 0; target[i]; i++)
+            rule->stmt[i] = tolower((unsigned char)target[i]);
+    } else if (!strcmp(target, "CONTINUE") || !target[0]) {
+        snprintf(rule->stmt, sizeof(rule->stmt), "counter");
+        rule->kind = NFT_STMT_OTHER;
+    } else if (nft_is_owned(target)) {
+        for (i = 0; (i < table->max_chains) && !chain; i++) {
+            if (!strcmp(table->chains[i].name, target))
+                chain = &(table->chains[i]);
+        }
+        if (!chain) {
+            LOGERROR("rule '%s' jumps to chain %s, which is not there\n", ebtrule, target);
+            return (1);
+        }
+        nft_name(target, name, sizeof(name));
+        snprintf(rule->stmt, sizeof(rule->stmt), "jump %s", name);
+    } else {
+        // e.g. arpreply, which nft has no counterpart of
+        return (1);
+    }
+    return (0);
+}
+
+//!
+//! Orders the rules of a chain as they are to be, pairs of { order, index }, by their insert
+//! order and then their index
+//!
+//! @param[in] p1 a pointer to the first pair
+//! @param[in] p2 a pointer to the second pair
+//!
+//! @return -1, 0 or 1 as the first pair comes before, with or after the second
+//!
+static int nft_ordercmp(const void *p1, const void *p2)
+{
+    const int *a = (const int *)p1;
+    const int *b = (const int *)p2;
+
+    if (a[0] != b[0])
+        return ((a[0] < b[0]) ? -1 : 1);
+    return ((a[1] < b[1]) ? -1 : ((a[1] > b[1]) ? 1 : 0));
+}
+
+//!
+//! Orders the rules of a run, by pointers to them, by their key and then their position
+//!
+//! @param[in] p1 a pointer to the pointer to the first rule
+//! @param[in] p2 a pointer to the pointer to the second rule
+//!
+//! @return -1, 0 or 1 as the first rule comes before, with or after the second
+//!
+static int nft_keycmp(const void *p1, const void *p2)
+{
+    const nft_rule *a = *((const nft_rule **)p1);
+    const nft_rule *b = *((const nft_rule **)p2);
+    int rc = 0;
+
+    if ((rc = strcmp(a->key, b->key)) != 0)
+        return (rc);
+    return ((a < b) ? -1 : ((a > b) ? 1 : 0));
+}
+
+//!
+//! Orders the addresses of a sec. group dispatch by address and then rule
+//!
+//! @param[in] p1 a pointer to the first address
+//! @param[in] p2 a pointer to the second address
+//!
+//! @return -1, 0 or 1 as the first address comes before, with or after the second
+//!
+static int nft_dispatchcmp(const void *p1, const void *p2)
+{
+    const nft_dispatch *a = (const nft_dispatch *)p1;
+    const nft_dispatch *b = (const nft_dispatch *)p2;
+
+    if (a->ip != b->ip)
+        return ((a->ip < b->ip) ? -1 : 1);
+    return ((a->rule < b->rule) ? -1 : ((a->rule > b->rule) ? 1 : 0));
+}
+
+//!
+//! Writes a rule
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] chain the nft name of the chain
+//! @param[in] match the matches of the rule, may be empty
+//! @param[in] stmt what the rule does
+//!
+static void nft_write_rule(nft_out * out, const char *chain, const char *match, const char *stmt)
+{
+    nft_begin_rule(out, chain, match);
+    fprintf(out->rules, " %s\n", stmt);
+}
+
+//!
+//! Writes the start of a rule, up to what it does
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] chain the nft name of the chain
+//! @param[in] match the matches of the rule, may be empty
+//!
+static void nft_begin_rule(nft_out * out, const char *chain, const char *match)
+{
+    fprintf(out->rules, "add rule %s %s%s %s%s%s", out->family, NFT_TABLE_PREFIX, out->table, chain, ((match[0]) ? " " : ""), match);
+}
+
+//!
+//! Writes a run of jumps to the sec. group chains, each on the destination being in the set
+//! of the group, as one verdict map on the destination address. The addresses in more than one
+//! group jump to a chain that jumps to the chains of their groups in turn, one chain for each
+//! distinct list of groups.
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] chain the nft name of the chain
+//! @param[in] rules the run
+//! @param[in] max_rules the number of rules in the run
+//! @param[in] ipsh pointer to the IP set handler structure
+//!
+//! @return 0 on success or 1 if the sets of the run are not all of single addresses
+//!
+static int nft_write_dispatch(nft_out * out, const char *chain, nft_rule * rules, int max_rules, ips_handler * ipsh)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int n = 0;
+    int max_dispatch = 0;
+    int *seq = NULL;
+    int *seqlen = NULL;
+    int *seqchain = NULL;
+    int max_seqs = 0;
+    int *owner = NULL;
+    int max_owners = 0;
+    char name[256] = "";
+    char addr[32] = "";
+    ips_set *set = NULL;
+    nft_dispatch *dispatch = NULL;
+
+    for (i = 0; i < max_rules; i++) {
+        if ((set = ips_handler_find_set(ipsh, rules[i].dstset)) == NULL)
+            return (1);
+        for (j = 0; j < set->max_member_ips; j++) {
+            if (set->member_nms[j] != 32)
+                return (1);
+        }
+        max_dispatch += set->max_member_ips;
+    }
+
+    dispatch = EUCA_ZALLOC((max_dispatch + 1), sizeof(nft_dispatch));
+    seq = EUCA_ZALLOC((max_dispatch + 1), sizeof(int));
+    seqlen = EUCA_ZALLOC((max_dispatch + 1), sizeof(int));
+    seqchain = EUCA_ZALLOC((max_dispatch + 1), sizeof(int));
+    owner = EUCA_ZALLOC((max_dispatch + 1), sizeof(int));
+    if (!dispatch || !seq || !seqlen || !seqchain || !owner) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+
+    for (i = 0, k = 0; i < max_rules; i++) {
+        set = ips_handler_find_set(ipsh, rules[i].dstset);
+        for (j = 0; j < set->max_member_ips; j++, k++) {
+            dispatch[k].ip = set->member_ips[j];
+            dispatch[k].rule = i;
+        }
+    }
+    qsort(dispatch, max_dispatch, sizeof(nft_dispatch), nft_dispatchcmp);
+    for (i = 0, k = 0; i < max_dispatch; i++) {
+        if (!k || (dispatch[i].ip != dispatch[k - 1].ip) || (dispatch[i].rule != dispatch[k - 1].rule))
+            dispatch[k++] = dispatch[i];
+    }
+    max_dispatch = k;
+
+    // the list of group rules of an address starts where the address does. The addresses with the same list of more
+    // than one group share a chain, which the first of them, its owner, gets.
+    for (i = 0; i < max_dispatch; i = j) {
+        for (j = i + 1; (j < max_dispatch) && (dispatch[j].ip == dispatch[i].ip); j++) ;
+        seq[max_seqs] = i;
+        seqlen[max_seqs] = j - i;
+        seqchain[max_seqs] = -1;
+        for (k = 0; (seqlen[max_seqs] > 1) && (k < max_owners) && (seqchain[max_seqs] < 0); k++) {
+            if (seqlen[owner[k]] == seqlen[max_seqs]) {
+                for (n = 0; (n < seqlen[max_seqs]) && (dispatch[seq[owner[k]] + n].rule == dispatch[i + n].rule); n++) ;
+                if (n == seqlen[max_seqs])
+                    seqchain[max_seqs] = seqchain[owner[k]];
+            }
+        }
+        if ((seqlen[max_seqs] > 1) && (seqchain[max_seqs] < 0)) {
+            owner[max_owners++] = max_seqs;
+            seqchain[max_seqs] = out->generated++;
+            snprintf(name, sizeof(name), "%s_D%d", chain, seqchain[max_seqs]);
+            nft_declare_chain(out, name, NULL);
+        }
+        max_seqs++;
+    }
+
+    if (max_seqs) {
+        nft_begin_rule(out, chain, "");
+        fprintf(out->rules, " ip daddr vmap { ");
+        for (i = 0; i < max_seqs; i++) {
+            nft_ipstr(dispatch[seq[i]].ip, addr, sizeof(addr));
+            if (seqchain[i] >= 0)
+                fprintf(out->rules, "%s%s : jump %s_D%d", NFT_ELEMENT_SEP(i), addr, chain, seqchain[i]);
+            else
+                fprintf(out->rules, "%s%s : %s", NFT_ELEMENT_SEP(i), addr, rules[dispatch[seq[i]].rule].stmt);
+        }
+        fprintf(out->rules, " }\n");
+    }
+
+    // the rules of the shared chains
+    for (k = 0; k < max_owners; k++) {
+        i = owner[k];
+        snprintf(name, sizeof(name), "%s_D%d", chain, seqchain[i]);
+        for (j = 0; j < seqlen[i]; j++)
+            nft_write_rule(out, name, "", rules[dispatch[seq[i] + j].rule].stmt);
+    }
+
+    EUCA_FREE(dispatch);
+    EUCA_FREE(seq);
+    EUCA_FREE(seqlen);
+    EUCA_FREE(seqchain);
+    EUCA_FREE(owner);
+    return (0);
+}
+
+//!
+//! Writes a run of rules that each match one exact address or interface, the key, as one map
+//! lookup on the key. When each key has a single rule, the rules become a verdict map, or a
+//! NAT map for DNAT on the destination or SNAT on the source, as long as all of them match the
+//! same otherwise. When some keys have more, each key gets a chain of its own rules, in order,
+//! and a verdict map jumps to those.
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] chain the nft name of the chain
+//! @param[in] rules the run, all keyed on the same thing
+//! @param[in] max_rules the number of rules in the run
+//!
+//! @return 0 on success or 1 if the run does not fit a map
+//!
+static int nft_write_keyed(nft_out * out, const char *chain, nft_rule * rules, int max_rules)
+{
+    int i = 0;
+    int j = 0;
+    int kind = 0;
+    int count = 0;
+    int first = 0;
+    boolean unique = TRUE;
+    boolean same = TRUE;
+    char name[256] = "";
+    nft_rule **sorted = NULL;
+
+    if ((sorted = EUCA_ZALLOC(max_rules, sizeof(nft_rule *))) == NULL) {
+        LOGFATAL("out of memory!\n");
+        exit(1);
+    }
+    for (i = 0; i < max_rules; i++) {
+        sorted[i] = &(rules[i]);
+        same = (same && !strcmp(rules[i].match, rules[0].match) && (rules[i].kind == rules[0].kind));
+    }
+    qsort(sorted, max_rules, sizeof(nft_rule *), nft_keycmp);
+    for (i = 1; (i < max_rules) && unique; i++) {
+        unique = (strcmp(sorted[i]->key, sorted[i - 1]->key) ? TRUE : FALSE);
+    }
+
+    kind = rules[0].kind;
+    if (unique && same && (kind == NFT_STMT_VERDICT)) {
+        nft_begin_rule(out, chain, rules[0].match);
+        fprintf(out->rules, " %s vmap { ", rules[0].keytype);
+        for (i = 0; i < max_rules; i++)
+            fprintf(out->rules, "%s%s : %s", NFT_ELEMENT_SEP(i), sorted[i]->key, sorted[i]->stmt);
+        fprintf(out->rules, " }\n");
+    } else if (unique && same && (((kind == NFT_STMT_DNAT) && !strcmp(rules[0].keytype, "ip daddr")) || ((kind == NFT_STMT_SNAT) && !strcmp(rules[0].keytype, "ip saddr")))) {
+        nft_begin_rule(out, chain, rules[0].match);
+        fprintf(out->rules, " %cnat to %s map { ", ((kind == NFT_STMT_DNAT) ? 'd' : 's'), rules[0].keytype);
+        for (i = 0; i < max_rules; i++)
+            fprintf(out->rules, "%s%s : %s", NFT_ELEMENT_SEP(i), sorted[i]->key, sorted[i]->natto);
+        fprintf(out->rules, " }\n");
+    } else if (!unique) {
+        // a 'return' from the chain of a key would only return to here
+        for (i = 0; i < max_rules; i++) {
+            if (!strcmp(rules[i].stmt, "return")) {
+                EUCA_FREE(sorted);
+                return (1);
+            }
+        }
+
+        first = out->generated;
+        nft_begin_rule(out, chain, "");
+        fprintf(out->rules, " %s vmap { ", rules[0].keytype);
+        for (i = 0; i < max_rules; i = j, count++) {
+            for (j = i + 1; (j < max_rules) && !strcmp(sorted[j]->key, sorted[i]->key); j++) ;
+            fprintf(out->rules, "%s%s : jump %s_K%d", NFT_ELEMENT_SEP(count), sorted[i]->key, chain, (first + count));
+        }
+        fprintf(out->rules, " }\n");
+
+        // the chains of the keys, with their rules in the order they had in the run
+        for (i = 0, count = 0; i < max_rules; i = j, count++) {
+            snprintf(name, sizeof(name), "%s_K%d", chain, (first + count));
+            nft_declare_chain(out, name, NULL);
+            for (j = i; (j < max_rules) && !strcmp(sorted[j]->key, sorted[i]->key); j++)
+                nft_write_rule(out, name, sorted[j]->match, sorted[j]->stmt);
+        }
+        out->generated += count;
+    } else {
+        EUCA_FREE(sorted);
+        return (1);
+    }
+
+    EUCA_FREE(sorted);
+    return (0);
+}
+
+//!
+//! Writes the rules of a chain, turning the runs of rules that fit them into maps
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] chain the nft name of the chain
+//! @param[in] rules the translated rules of the chain, in order
+//! @param[in] max_rules the number of rules
+//! @param[in] ipsh pointer to the IP set handler structure
+//!
+static void nft_write_rules(nft_out * out, const char *chain, nft_rule * rules, int max_rules, ips_handler * ipsh)
+{
+    int i = 0;
+    int j = 0;
+    char match[NFT_MAX_MATCH_LEN + 128] = "";
+    char name[256] = "";
+
+#define _DISPATCH(_r)                 ((_r)->dstset[0] && !(_r)->keytype[0] && !strncmp((_r)->stmt, "jump ", 5) && \
+                                       (nft_name((_r)->dstset, name, sizeof(name)), snprintf(match, sizeof(match), "ip daddr @%s", name), !strcmp((_r)->match, match)))
+    for (i = 0; i < max_rules; i = j) {
+        if (_DISPATCH(&(rules[i]))) {
+            for (j = i + 1; (j < max_rules) && _DISPATCH(&(rules[j])); j++) ;
+            if (((j - i) >= NFT_MIN_DISPATCH_RUN) && !nft_write_dispatch(out, chain, &(rules[i]), (j - i), ipsh))
+                continue;
+        }
+
+        if (rules[i].keytype[0]) {
+            // the rules that only differ in their key make the best maps, then those keyed alike
+            for (j = i + 1; (j < max_rules) && !strcmp(rules[j].keytype, rules[i].keytype) && !strcmp(rules[j].match, rules[i].match)
+                 && (rules[j].kind == rules[i].kind); j++) ;
+            if (((j - i) >= NFT_MIN_MAP_RUN) && !nft_write_keyed(out, chain, &(rules[i]), (j - i)))
+                continue;
+            for (j = i + 1; (j < max_rules) && !strcmp(rules[j].keytype, rules[i].keytype); j++) ;
+            if (((j - i) >= NFT_MIN_MAP_RUN) && !nft_write_keyed(out, chain, &(rules[i]), (j - i)))
+                continue;
+        }
+
+        j = i + 1;
+        if (rules[i].keytype[0]) {
+            snprintf(match, sizeof(match), "%s %s%s%s", rules[i].keytype, rules[i].key, ((rules[i].match[0]) ? " " : ""), rules[i].match);
+            nft_write_rule(out, chain, match, rules[i].stmt);
+        } else {
+            nft_write_rule(out, chain, rules[i].match, rules[i].stmt);
+        }
+    }
+#undef _DISPATCH
+}
+
+//!
+//! Declares a chain of the table
+//!
+//! @param[in] out what is being written for the table
+//! @param[in] chain the nft name of the chain
+//! @param[in] hook where the chain hooks in, NULL for a regular chain
+//!
+static void nft_declare_chain(nft_out * out, const char *chain, const nft_hook * hook)
+{
+    fprintf(out->chains, "\tchain %s {\n", chain);
+    if (hook) {
+        fprintf(out->chains, "\t\ttype %s hook %s priority %d; policy accept;\n", hook->type, hook->hook, hook->priority);
+    }
+    fprintf(out->chains, "\t}\n");
+}
+
+//!
+//! Renders the chains of a table of the IP table handler: the ones eucanetd owns and the
+//! built-in ones that have rules
+//!
+//! @param[in] table the table
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] out what is being written for the table
+//!
+//! @return 0 on success or 1 if a rule could not be rendered
+//!
+static int nft_render_ipt_table(ipt_table * table, ips_handler * ipsh, nft_out * out)
+{
+    int i = 0;
+    int j = 0;
+    int max_rules = 0;
+    int (*order)[2] = NULL;
+    char name[256] = "";
+    ipt_chain *chain = NULL;
+    nft_rule *rules = NULL;
+    const nft_hook *hook = NULL;
+
+    for (i = 0; i < table->max_chains; i++) {
+        chain = &(table->chains[i]);
+        hook = nft_find_hook(out->family, table->name, chain->name);
+        if (chain->flushed || (!hook && !nft_is_owned(chain->name))) {
+            continue;
+        }
+
+        order = EUCA_ZALLOC((chain->max_rules + 1), sizeof(int[2]));
+        rules = EUCA_ZALLOC((chain->max_rules + 1), sizeof(nft_rule));
+        if (!order || !rules) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        for (j = 0, max_rules = 0; j < chain->max_rules; j++) {
+            if (!chain->rules[j].flushed) {
+                order[max_rules][0] = chain->rules[j].order;
+                order[max_rules][1] = j;
+                max_rules++;
+            }
+        }
+        qsort(order, max_rules, sizeof(int[2]), nft_ordercmp);
+
+        for (j = 0; j < max_rules; j++) {
+            if (nft_ipt_translate(chain->rules[order[j][1]].iptrule, table, ipsh, out, &(rules[j]))) {
+                LOGERROR("cannot render rule '%s' of %s/%s for nftables\n", chain->rules[order[j][1]].iptrule, table->name, chain->name);
+                EUCA_FREE(order);
+                EUCA_FREE(rules);
+                return (1);
+            }
+        }
+
+        if (!hook || max_rules) {
+            nft_name(chain->name, name, sizeof(name));
+            nft_declare_chain(out, name, hook);
+            nft_write_rules(out, name, rules, max_rules, ipsh);
+        }
+        EUCA_FREE(order);
+        EUCA_FREE(rules);
+    }
+    return (0);
+}
+
+//!
+//! Renders the chains of a table of the EB table handler: the ones eucanetd owns and the
+//! built-in ones that have rules
+//!
+//! @param[in] table the table
+//! @param[in] out what is being written for the table
+//!
+//! @return 0 on success or 1 if a rule could not be rendered
+//!
+static int nft_render_ebt_table(ebt_table * table, nft_out * out)
+{
+    int i = 0;
+    int j = 0;
+    char name[256] = "";
+    ebt_chain *chain = NULL;
+    nft_rule *rules = NULL;
+    const nft_hook *hook = NULL;
+
+    for (i = 0; i < table->max_chains; i++) {
+        chain = &(table->chains[i]);
+        hook = nft_find_hook(out->family, table->name, chain->name);
+        if (!hook && !nft_is_owned(chain->name)) {
+            continue;
+        }
+
+        if ((rules = EUCA_ZALLOC((chain->max_rules + 1), sizeof(nft_rule))) == NULL) {
+            LOGFATAL("out of memory!\n");
+            exit(1);
+        }
+        for (j = 0; j < chain->max_rules; j++) {
+            if (nft_ebt_translate(chain->rules[j].ebtrule, table, &(rules[j]))) {
+                LOGERROR("cannot render rule '%s' of %s/%s for nftables\n", chain->rules[j].ebtrule, table->name, chain->name);
+                EUCA_FREE(rules);
+                return (1);
+            }
+        }
+
+        if (!hook || chain->max_rules) {
+            nft_name(chain->name, name, sizeof(name));
+            nft_declare_chain(out, name, hook);
+            nft_write_rules(out, name, rules, chain->max_rules, NULL);
+        }
+        EUCA_FREE(rules);
+    }
+    return (0);
+}
+
+//!
+//! Declares the sets the rules of a table reference, with their members
+//!
+//! @param[in] FH the ruleset being written
+//! @param[in] out what is being written for the table
+//! @param[in] ipsh pointer to the IP set handler structure
+//!
+static void nft_write_sets(FILE * FH, nft_out * out, ips_handler * ipsh)
+{
+    int i = 0;
+    int j = 0;
+    u32 mask = 0;
+    char name[256] = "";
+    char addr[32] = "";
+    ips_set *set = NULL;
+
+    for (i = 0; i < out->max_sets; i++) {
+        if ((set = ips_handler_find_set(ipsh, out->sets[i])) == NULL) {
+            continue;
+        }
+
+        nft_name(set->name, name, sizeof(name));
+        fprintf(FH, "\tset %s {\n\t\ttype ipv4_addr\n\t\tflags interval\n\t\tauto-merge\n", name);
+        if (set->max_member_ips) {
+            fprintf(FH, "\t\telements = { ");
+            for (j = 0; j < set->max_member_ips; j++) {
+                mask = ((set->member_nms[j] <= 0) ? 0 : ((set->member_nms[j] >= 32) ? 0xFFFFFFFF : (0xFFFFFFFF << (32 - set->member_nms[j]))));
+                nft_ipstr((set->member_ips[j] & mask), addr, sizeof(addr));
+                if (mask == 0xFFFFFFFF)
+                    fprintf(FH, "%s%s", NFT_ELEMENT_SEP(j), addr);
+                else
+                    fprintf(FH, "%s%s/%d", NFT_ELEMENT_SEP(j), addr, ((set->member_nms[j] < 0) ? 0 : set->member_nms[j]));
+            }
+            fprintf(FH, " }\n");
+        }
+        fprintf(FH, "\t}\n");
+    }
+}
+
+//!
+//! Writes what was rendered for a table: its block of set and chain declarations, then its rules
+//!
+//! @param[in] FH the ruleset being written
+//! @param[in] out what was rendered for the table
+//! @param[in] ipsh pointer to the IP set handler structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int nft_write_table(FILE * FH, nft_out * out, ips_handler * ipsh)
+{
+    if (fflush(out->chains) || fflush(out->rules)) {
+        LOGERROR("could not write the nftables ruleset\n");
+        return (1);
+    }
+
+    if (out->chainslen) {
+        fprintf(FH, "table %s %s%s {\n", out->family, NFT_TABLE_PREFIX, out->table);
+        nft_write_sets(FH, out, ipsh);
+        fwrite(out->chainsbuf, 1, out->chainslen, FH);
+        fprintf(FH, "}\n");
+        fwrite(out->rulesbuf, 1, out->ruleslen, FH);
+    }
+    return (0);
+}
+
+//!
+//! Sets up what gets rendered for a table
+//!
+//! @param[out] out what is being written for the table
+//! @param[in]  family 'ip' or 'bridge'
+//! @param[in]  table the iptables or ebtables name of the table
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int nft_out_init(nft_out * out, const char *family, const char *table)
+{
+    bzero(out, sizeof(nft_out));
+    out->family = family;
+    out->table = table;
+    out->rules = open_memstream(&(out->rulesbuf), &(out->ruleslen));
+    out->chains = open_memstream(&(out->chainsbuf), &(out->chainslen));
+    if (!out->rules || !out->chains) {
+        LOGERROR("could not set up the rendering of table %s %s\n", family, table);
+        nft_out_free(out);
+        return (1);
+    }
+    return (0);
+}
+
+//!
+//! Releases what was rendered for a table
+//!
+//! @param[in] out what was written for the table
+//!
+static void nft_out_free(nft_out * out)
+{
+    int i = 0;
+
+    if (out->rules)
+        fclose(out->rules);
+    if (out->chains)
+        fclose(out->chains);
+    EUCA_FREE(out->rulesbuf);
+    EUCA_FREE(out->chainsbuf);
+    for (i = 0; i < out->max_sets; i++)
+        EUCA_FREE(out->sets[i]);
+    EUCA_FREE(out->sets);
+    bzero(out, sizeof(nft_out));
+}
+
+//!
+//! Writes the start of every ruleset: the removal of all the tables eucanetd owns. A table
+//! is added before it is deleted, which does not fail on a table that is not there.
+//!
+//! @param[in] FH the ruleset being written
+//!
+static void nft_write_preamble(FILE * FH)
+{
+    int i = 0;
+
+    for (i = 0; nft_hooks[i].family; i++) {
+        if ((i == 0) || strcmp(nft_hooks[i].family, nft_hooks[i - 1].family) || strcmp(nft_hooks[i].table, nft_hooks[i - 1].table)) {
+            fprintf(FH, "add table %s %s%s\n", nft_hooks[i].family, NFT_TABLE_PREFIX, nft_hooks[i].table);
+            fprintf(FH, "delete table %s %s%s\n", nft_hooks[i].family, NFT_TABLE_PREFIX, nft_hooks[i].table);
+        }
+    }
+}
+
+//!
+//! Renders the models of the handlers as one nftables ruleset, which replaces the tables
+//! eucanetd owns as a whole
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//! @param[in] ipth pointer to the IP table handler structure
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] ebth pointer to the EB table handler structure
+//! @param[in] FH where to write the ruleset
+//!
+//! @return 0 on success or 1 if some rule could not be rendered
+//!
+int nft_handler_render(nft_handler * nfth, ipt_handler * ipth, ips_handler * ipsh, ebt_handler * ebth, FILE * FH)
+{
+    int i = 0;
+    int rc = 0;
+    nft_out out = { 0 };
+
+    if (!nfth || !ipth || !ipsh || !ebth || !FH) {
+        return (1);
+    }
+
+    nft_write_preamble(FH);
+
+    for (i = 0; (i < ipth->max_tables) && !rc; i++) {
+        if (!nft_find_hook("ip", ipth->tables[i].name, NULL)) {
+            LOGDEBUG("not rendering iptables table %s, which has no nftables counterpart\n", ipth->tables[i].name);
+            continue;
+        }
+        if ((rc = nft_out_init(&out, "ip", ipth->tables[i].name)) == 0) {
+            if ((rc = nft_render_ipt_table(&(ipth->tables[i]), ipsh, &out)) == 0) {
+                rc = nft_write_table(FH, &out, ipsh);
+            }
+            nft_out_free(&out);
+        }
+    }
+
+    for (i = 0; (i < ebth->max_tables) && !rc; i++) {
+        if (!nft_find_hook("bridge", ebth->tables[i].name, NULL)) {
+            LOGDEBUG("not rendering ebtables table %s, which has no nftables counterpart\n", ebth->tables[i].name);
+            continue;
+        }
+        if ((rc = nft_out_init(&out, "bridge", ebth->tables[i].name)) == 0) {
+            if ((rc = nft_render_ebt_table(&(ebth->tables[i]), &out)) == 0) {
+                rc = nft_write_table(FH, &out, ipsh);
+            }
+            nft_out_free(&out);
+        }
+    }
+
+    return (rc ? 1 : 0);
+}
+
+//!
+//! Feeds the nftables handler file to nft, without going through a shell
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//!
+//! @return 0 on success or the nft exit code on failure
+//!
+static int nft_system_restore(nft_handler * nfth)
+{
+    int i = 0;
+    int rc = 0;
+    int status = 0;
+    char prefix[EUCA_MAX_PATH] = "";
+    char *argv[16] = { NULL };
+    char *ptr = NULL;
+    char *tok = NULL;
+
+    // the command prefix (e.g. the rootwrap) may carry arguments of its own
+    euca_strncpy(prefix, nfth->cmdprefix, EUCA_MAX_PATH);
+    for (tok = strtok_r(prefix, " ", &ptr); tok && (i < 12); tok = strtok_r(NULL, " ", &ptr))
+        argv[i++] = tok;
+    argv[i++] = "nft";
+    argv[i++] = "-f";
+    argv[i++] = nfth->nft_file;
+    argv[i] = NULL;
+
+    if ((rc = euca_run(argv, NULL, 0, 0, NULL, NULL, &status)) != EUCA_OK) {
+        rc = (((rc == EUCA_ERROR) && WIFEXITED(status)) ? WEXITSTATUS(status) : 1);
+        copy_file(nfth->nft_file, "/tmp/euca_nft_file_failed");
+        LOGERROR("nft failed '%s nft -f %s': copying failed input file to '/tmp/euca_nft_file_failed' for manual retry.\n", nfth->cmdprefix, nfth->nft_file);
+    }
+    unlink(nfth->nft_file);
+    return (rc);
+}
+
+//!
+//! @param[in] buf the rendered ruleset
+//! @param[in] len its length
+//!
+//! @return the FNV-1a hash of the ruleset
+//!
+static unsigned long long nft_hash(const char *buf, size_t len)
+{
+    size_t i = 0;
+    unsigned long long h = 14695981039346656037ULL;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)buf[i];
+        h *= 1099511628211ULL;
+    }
+    return (h);
+}
+
+//!
+//! Applies the models of the handlers as one nftables transaction: all the filter, NAT and
+//! bridge rules and sets change together, or nothing changes. Nothing is applied when the
+//! ruleset is the same as the one last applied.
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//! @param[in] ipth pointer to the IP table handler structure
+//! @param[in] ipsh pointer to the IP set handler structure
+//! @param[in] ebth pointer to the EB table handler structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+int nft_handler_deploy(nft_handler * nfth, ipt_handler * ipth, ips_handler * ipsh, ebt_handler * ebth)
+{
+    int rc = 0;
+    char *buf = NULL;
+    size_t len = 0;
+    unsigned long long hash = 0;
+    FILE *FH = NULL;
+
+    if (!nfth || !ipth || !ipsh || !ebth || !nfth->init || !ipth->init || !ipsh->init || !ebth->init) {
+        return (1);
+    }
+
+    if ((FH = open_memstream(&buf, &len)) == NULL) {
+        LOGERROR("could not set up the rendering of the nftables ruleset\n");
+        return (1);
+    }
+    rc = nft_handler_render(nfth, ipth, ipsh, ebth, FH);
+    fclose(FH);
+    if (rc) {
+        LOGERROR("could not render the nftables ruleset: check above log errors for details\n");
+        EUCA_FREE(buf);
+        return (1);
+    }
+
+    hash = nft_hash(buf, len);
+    if (nfth->deployed_hash && (hash == nfth->deployed_hash)) {
+        LOGDEBUG("nftables ruleset unchanged, not applying\n");
+        EUCA_FREE(buf);
+        return (0);
+    }
+
+    if (((FH = fopen(nfth->nft_file, "w")) == NULL) || (fwrite(buf, 1, len, FH) != len)) {
+        LOGERROR("could not open file for write '%s': check permissions\n", nfth->nft_file);
+        if (FH)
+            fclose(FH);
+        EUCA_FREE(buf);
+        return (1);
+    }
+    fclose(FH);
+    EUCA_FREE(buf);
+
+    if ((rc = nft_system_restore(nfth)) != 0) {
+        nfth->deployed_hash = 0;
+        return (1);
+    }
+    nfth->deployed_hash = hash;
+    return (0);
+}
+
+//!
+//! Removes the tables eucanetd owns
+//!
+//! @param[in] nfth pointer to the nftables handler structure
+//!
+//! @return 0 on success or 1 on failure
+//!
+int nft_handler_flush(nft_handler * nfth)
+{
+    FILE *FH = NULL;
+
+    if (!nfth || !nfth->init) {
+        return (1);
+    }
+
+    if ((FH = fopen(nfth->nft_file, "w")) == NULL) {
+        LOGERROR("could not open file for write '%s': check permissions\n", nfth->nft_file);
+        return (1);
+    }
+    nft_write_preamble(FH);
+    fclose(FH);
+
+    nfth->deployed_hash = 0;
+    return ((nft_system_restore(nfth)) ? 1 : 0);
+}
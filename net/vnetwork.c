@@ -78,6 +78,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>                   /* ffs */
 #include <ctype.h>
 #include <math.h>
 #include <unistd.h>
@@ -89,14 +90,22 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <errno.h>
 #include <ifaddrs.h>
 #include <math.h>                      /* log2 */
 #include <sys/socket.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <sys/un.h>
 
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/if_tunnel.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nfnetlink_conntrack.h>
 
 #include <eucalyptus.h>
 #include <misc.h>
@@ -113,6 +122,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define ASSIGN_BATCH_NAT                         0  //!< index of the nat rules in an assignment batch
+#define ASSIGN_BATCH_FILTER                      1  //!< index of the filter rules in an assignment batch
+#define ASSIGN_BATCH_TABLES                      2
+#define NETLINK_BATCH_ADDRS                      256    //!< most address requests sent to the kernel in one netlink message
+#define CONNTRACK_DUMP_BUFSIZE           (64 * 1024)    //!< room for one read of a ctnetlink dump
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -131,6 +146,38 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! a host entry of a DHCP daemon config file, as written by vnetGenerateDHCP()
+typedef struct dhcpHostEntry_t {
+    char name[64];
+    char mac[24];
+    char ip[24];
+} dhcpHostEntry;
+
+//! the rules and addresses vnetAssignAddress() puts off between vnetAssignBatchBegin() and vnetAssignBatchCommit()
+typedef struct vnetAssignBatch_t {
+    boolean active;
+    pthread_t owner;                   //!< only the assignments of this thread go into the batch
+    char *rules[ASSIGN_BATCH_TABLES];  //!< one rule per line, for each table
+    size_t len[ASSIGN_BATCH_TABLES];
+    size_t size[ASSIGN_BATCH_TABLES];
+    u32 *ips;                          //!< addresses to add to the public interface
+    int numIps;
+    int maxIps;
+    u32 *movedIps;                     //!< addresses that moved, their conntrack entries go once the rules are in
+    int numMovedIps;
+    int maxMovedIps;
+} vnetAssignBatch;
+
+//! a request to rtnetlink, with room for the attributes of a link or an address
+typedef struct vnetNetlinkReq_t {
+    struct nlmsghdr nh;
+    union {
+        struct ifinfomsg ifi;
+        struct ifaddrmsg ifa;
+    } u;
+    char attrs[512];
+} vnetNetlinkReq;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -153,12 +200,48 @@ char *iptablesCache = NULL;            //!< contains the IP tables cache
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static vnetAssignBatch assignBatch = { 0 };    //!< the assignment batch of this process, if one is open
+static boolean netlinkAllowed = TRUE;  //!< cleared once the kernel turns down a netlink request of this process for lack of privileges
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int vnetFindBit(const u32 * map, int start, int stop, boolean set);
+static netEntry *vnetAllocAddrs(vnetConfig * vnetconfig, int vlan);
+static void vnetFreeAddrs(vnetConfig * vnetconfig, int vlan);
+static void vnetSyncAddr(vnetConfig * vnetconfig, int vlan, int idx);
+static u32 vnetPublicIPBucket(u32 ip);
+static int vnetFindPublicIP(vnetConfig * vnetconfig, u32 ip);
+static int vnetInsertPublicIP(vnetConfig * vnetconfig, u32 ip);
+static void vnetRemovePublicIP(vnetConfig * vnetconfig, int idx);
+static void vnetTouchPublicIP(vnetConfig * vnetconfig, int idx);
+static void vnetSplitDHCPConf(char *conf, dhcpHostEntry ** outhosts, int *outmax);
+static dhcpHostEntry *vnetFindDHCPHost(dhcpHostEntry * hosts, int max_hosts, char *name);
+static boolean vnetAssignBatching(void);
+static int vnetAssignRule(vnetConfig * vnetconfig, char *table, char *rule);
+static int vnetAssignIP(vnetConfig * vnetconfig, char *src);
+static int vnetNetlinkAddAddrs(const char *dev, const u32 * ips, int numIps);
+static boolean vnetConntrackTupleIps(struct nlattr *tuple, u32 * src, u32 * dst);
+static int vnetNetlinkConntrackDelete(const u32 * ips, int numIps, int *deleted);
+static int vnetNetlinkTalk(struct nlmsghdr *nh);
+static struct rtattr *vnetNetlinkAttr(struct nlmsghdr *nh, int type, const void *data, int len);
+static void vnetNetlinkNestEnd(struct nlmsghdr *nh, struct rtattr *nest);
+static struct ifinfomsg *vnetNetlinkLinkReq(vnetNetlinkReq * req, int type, int flags, int ifindex);
+static int vnetRootwrap(vnetConfig * vnetconfig, const char *format, ...) _attribute_format_(2, 3);
+static int vnetLinkAddVlan(vnetConfig * vnetconfig, const char *dev, int vlan);
+static int vnetLinkDelVlan(vnetConfig * vnetconfig, const char *dev);
+static int vnetLinkAddTunnel(vnetConfig * vnetconfig, const char *dev, int localId, int remoteId);
+static int vnetLinkDelTunnel(vnetConfig * vnetconfig, const char *dev);
+static int vnetLinkAddBridge(vnetConfig * vnetconfig, const char *brname, boolean quick);
+static int vnetBridgeSetStp(vnetConfig * vnetconfig, const char *brname, boolean on);
+static int vnetLinkSetMaster(vnetConfig * vnetconfig, const char *brname, const char *dev);
+static int vnetLinkSetUp(vnetConfig * vnetconfig, const char *dev, boolean up);
+static int vnetAddrChange(vnetConfig * vnetconfig, boolean add, const char *dev, u32 ip, int slashnet, u32 broadcast);
+static int vnetAddrFlush(vnetConfig * vnetconfig, const char *dev);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -412,8 +495,12 @@ int vnetInit(vnetConfig * vnetconfig, char *mode, char *eucahome, char *path, in
         // populate networks
         bzero(vnetconfig->users, sizeof(userEntry) * NUMBER_OF_VLANS);
         bzero(vnetconfig->networks, sizeof(networkEntry) * NUMBER_OF_VLANS);
+        bzero(vnetconfig->addrPoolMap, sizeof(vnetconfig->addrPoolMap));
         bzero(vnetconfig->etherdevs, NUMBER_OF_VLANS * MAX_ETH_DEV_PATH);
         bzero(vnetconfig->publicips, sizeof(publicip) * NUMBER_OF_PUBLIC_IPS);
+        bzero(vnetconfig->publicipMap, sizeof(vnetconfig->publicipMap));
+        bzero(vnetconfig->publicipHash, sizeof(vnetconfig->publicipHash));
+        vnetconfig->publicipSeq = 0;
 
         if (role != NC) {
             if (network)
@@ -500,6 +587,11 @@ int vnetInit(vnetConfig * vnetconfig, char *mode, char *eucahome, char *path, in
             }
         }
 
+        // the host entries of a network are only allocated from the pool once the network needs them
+        vnetconfig->addrBlockSize = (vnetconfig->numaddrs > NUMBER_OF_HOSTS_PER_VLAN) ? NUMBER_OF_HOSTS_PER_VLAN : vnetconfig->numaddrs;
+        if (vnetconfig->addrBlockSize < 0)
+            vnetconfig->addrBlockSize = 0;
+
         LOGINFO(" VNET Configuration: eucahome=%s,\n", SP(vnetconfig->eucahome));
         LOGINFO("                     path=%s,\n", SP(vnetconfig->path));
         LOGINFO("                     dhcpdaemon=%s,\n", SP(vnetconfig->dhcpdaemon));
@@ -738,6 +830,9 @@ int vnetInitTunnels(vnetConfig * vnetconfig)
         } else if (!strcmp(vnetconfig->mode, NETMODE_MANAGED_NOVLAN) && check_bridge(vnetconfig->privInterface)) {
             LOGWARN("in MANAGED-NOVLAN mode, priv interface '%s' must be a bridge, tunneling disabled\n", vnetconfig->privInterface);
             return (EUCA_OK);
+        } else if (vnetconfig->tunnels.mode != TUNNEL_VTUN) {
+            // kernel tunnels have no configuration file to set up
+            ret = EUCA_OK;
         } else {
             ret = EUCA_OK;
             snprintf(file, EUCA_MAX_PATH, EUCALYPTUS_KEYS_DIR "/vtunpass", vnetconfig->eucahome);
@@ -789,6 +884,190 @@ int vnetInitTunnels(vnetConfig * vnetconfig)
     return (ret);
 }
 
+//!
+//! Selects how the tunnels between the CCs are built. VTUN runs a userspace vtund per tunnel,
+//! VXLAN and GRE have the kernel carry the tagged frames of every network between each pair
+//! of CCs, over one VXLAN or gretap device per CC pair. The tunnels built the other way are
+//! torn down when the mode changes.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] mode the VNET_TUNNEL_MODE value, "VTUN", "VXLAN" or "GRE", or NULL for "VTUN"
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the mode is unknown, in which case
+//!         the mode does not change
+//!
+//! @pre \p vnetconfig must not be NULL.
+//!
+int vnetSetTunnelMode(vnetConfig * vnetconfig, const char *mode)
+{
+    int newmode = TUNNEL_VTUN;
+
+    if (!vnetconfig) {
+        LOGERROR("bad input params: vnetconfig=%p\n", vnetconfig);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (!mode || !strcasecmp(mode, "VTUN")) {
+        newmode = TUNNEL_VTUN;
+    } else if (!strcasecmp(mode, "VXLAN")) {
+        newmode = TUNNEL_VXLAN;
+    } else if (!strcasecmp(mode, "GRE")) {
+        newmode = TUNNEL_GRE;
+    } else {
+        LOGWARN("unknown VNET_TUNNEL_MODE '%s', keeping the current tunnel mode\n", mode);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (newmode != vnetconfig->tunnels.mode) {
+        LOGINFO("tunnel mode set to %s\n", ((newmode == TUNNEL_VTUN) ? "VTUN" : ((newmode == TUNNEL_VXLAN) ? "VXLAN" : "GRE")));
+        vnetTeardownTunnels(vnetconfig);
+        vnetconfig->tunnels.mode = newmode;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the first bit of a bitmap within the [start..stop] range that matches the given value
+//!
+//! @param[in] map the bitmap to search
+//! @param[in] start the first bit index to look at
+//! @param[in] stop the last bit index to look at
+//! @param[in] set TRUE to look for a set bit or FALSE to look for a cleared bit
+//!
+//! @return the index of the matching bit or -1 if none is found in the range
+//!
+static int vnetFindBit(const u32 * map, int start, int stop, boolean set)
+{
+    int i = 0;
+    u32 word = 0;
+
+    for (i = start; (i >= 0) && (i <= stop); i = ((i & ~31) + 32)) {
+        word = ((set) ? map[i / 32] : ~map[i / 32]) & (0xFFFFFFFF << (i % 32));
+        if (word) {
+            i = (i & ~31) + (ffs(word) - 1);
+            return ((i <= stop) ? i : -1);
+        }
+    }
+    return (-1);
+}
+
+//!
+//! Retrieves the host entries of a given network
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] vlan the Virtual LAN index
+//!
+//! @return a pointer to the vnetconfig->addrBlockSize host entries of the network or NULL if
+//!         the network has none allocated.
+//!
+netEntry *vnetGetAddrs(vnetConfig * vnetconfig, int vlan)
+{
+    int block = 0;
+
+    if ((vnetconfig == NULL) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS))
+        return (NULL);
+
+    if ((block = vnetconfig->networks[vlan].addrBlock) <= 0)
+        return (NULL);
+    return (&(vnetconfig->addrPool[(block - 1) * vnetconfig->addrBlockSize]));
+}
+
+//!
+//! Retrieves the host entries of a given network, allocating a block from the pool if the
+//! network does not have one yet. A new block starts with all its host indexes free.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] vlan the Virtual LAN index
+//!
+//! @return a pointer to the host entries of the network or NULL if the pool is exhausted
+//!
+static netEntry *vnetAllocAddrs(vnetConfig * vnetconfig, int vlan)
+{
+    int i = 0;
+    int block = 0;
+    int nblocks = 0;
+    netEntry *addrs = NULL;
+    networkEntry *network = NULL;
+
+    if ((addrs = vnetGetAddrs(vnetconfig, vlan)) != NULL)
+        return (addrs);
+
+    if ((vnetconfig == NULL) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS) || (vnetconfig->addrBlockSize <= 0))
+        return (NULL);
+
+    if ((nblocks = (NUMBER_OF_POOLED_ADDRS / vnetconfig->addrBlockSize)) > NUMBER_OF_VLANS)
+        nblocks = NUMBER_OF_VLANS;
+
+    if ((block = vnetFindBit(vnetconfig->addrPoolMap, 0, (nblocks - 1), FALSE)) < 0) {
+        LOGERROR("no host entries left for vlan %d (%d networks of %d addresses already allocated)\n", vlan, nblocks, vnetconfig->addrBlockSize);
+        return (NULL);
+    }
+
+    vnetconfig->addrPoolMap[block / 32] |= (1U << (block % 32));
+    addrs = &(vnetconfig->addrPool[block * vnetconfig->addrBlockSize]);
+    bzero(addrs, (sizeof(netEntry) * vnetconfig->addrBlockSize));
+
+    network = &(vnetconfig->networks[vlan]);
+    network->addrBlock = block + 1;
+    bzero(network->freeAddrs, sizeof(network->freeAddrs));
+    bzero(network->readyAddrs, sizeof(network->readyAddrs));
+    for (i = 0; i < vnetconfig->addrBlockSize; i++) {
+        network->freeAddrs[i / 32] |= (1U << (i % 32));
+    }
+    return (addrs);
+}
+
+//!
+//! Returns the block of host entries of a given network to the pool
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] vlan the Virtual LAN index
+//!
+static void vnetFreeAddrs(vnetConfig * vnetconfig, int vlan)
+{
+    int block = 0;
+    networkEntry *network = NULL;
+
+    if ((vnetconfig == NULL) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS))
+        return;
+
+    network = &(vnetconfig->networks[vlan]);
+    if ((block = network->addrBlock - 1) >= 0)
+        vnetconfig->addrPoolMap[block / 32] &= ~(1U << (block % 32));
+
+    network->addrBlock = 0;
+    bzero(network->freeAddrs, sizeof(network->freeAddrs));
+    bzero(network->readyAddrs, sizeof(network->readyAddrs));
+}
+
+//!
+//! Updates the host bitmaps of a network after the given host entry changed
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] vlan the Virtual LAN index
+//! @param[in] idx the host index
+//!
+//! @pre The network must have host entries allocated and \p idx must be less than vnetconfig->addrBlockSize
+//!
+static void vnetSyncAddr(vnetConfig * vnetconfig, int vlan, int idx)
+{
+    u32 bit = (1U << (idx % 32));
+    netEntry *addr = &(vnetGetAddrs(vnetconfig, vlan)[idx]);
+    networkEntry *network = &(vnetconfig->networks[vlan]);
+
+    if (maczero(addr->mac)) {
+        network->freeAddrs[idx / 32] &= ~bit;
+    } else {
+        network->freeAddrs[idx / 32] |= bit;
+    }
+
+    if (maczero(addr->mac) && (addr->ip != 0) && (addr->active == 0)) {
+        network->readyAddrs[idx / 32] |= bit;
+    } else {
+        network->readyAddrs[idx / 32] &= ~bit;
+    }
+}
+
 //!
 //! Adds a given host \p mac / \p ip to our network configuration.
 //!
@@ -820,6 +1099,8 @@ int vnetAddHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int idx)
     int stop = 0;
     char *newip = NULL;
     boolean done = FALSE;
+    netEntry *addrs = NULL;
+    networkEntry *network = NULL;
 
     if (param_check("vnetAddHost", vnetconfig, mac, ip, vlan)) {
         LOGERROR("bad input params: vnetconfig=%p, mac=%s, ip=%s, idx=%d\n", vnetconfig, SP(mac), SP(ip), idx);
@@ -842,34 +1123,40 @@ int vnetAddHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int idx)
         return (EUCA_INVALID_ERROR);
     }
 
-    for (i = start, done = FALSE, found = 0; ((i <= stop) && !done); i++) {
-        if (!maczero(vnetconfig->networks[vlan].addrs[i].mac)) {
-            if (!found)
-                found = i;
-        } else if (!machexcmp(mac, vnetconfig->networks[vlan].addrs[i].mac)) {
+    if ((addrs = vnetAllocAddrs(vnetconfig, vlan)) == NULL) {
+        LOGERROR("failed to add host %s on vlan %d\n", mac, vlan);
+        return (EUCA_ERROR);
+    }
+    network = &(vnetconfig->networks[vlan]);
+
+    // only the host indexes that have a MAC assigned can hold a duplicate
+    for (i = vnetFindBit(network->freeAddrs, start, stop, FALSE); ((i >= 0) && !done); i = vnetFindBit(network->freeAddrs, (i + 1), stop, FALSE)) {
+        if (!machexcmp(mac, addrs[i].mac)) {
             done = TRUE;
         }
     }
+    found = vnetFindBit(network->freeAddrs, start, stop, TRUE);
 
     if (done) {
         // duplicate IP found
         LOGWARN("attempting to add duplicate macmap entry, ignoring\n");
-    } else if (found) {
-        if (mac2hex(mac, vnetconfig->networks[vlan].addrs[found].mac) != NULL) {
+    } else if (found > 0) {
+        if (mac2hex(mac, addrs[found].mac) != NULL) {
             if (ip) {
-                vnetconfig->networks[vlan].addrs[found].ip = dot2hex(ip);
+                addrs[found].ip = dot2hex(ip);
             } else {
-                if ((newip = hex2dot(vnetconfig->networks[vlan].nw + found)) == NULL) {
+                if ((newip = hex2dot(network->nw + found)) == NULL) {
                     LOGWARN("Out of memory\n");
                 } else {
-                    vnetconfig->networks[vlan].addrs[found].ip = dot2hex(newip);
+                    addrs[found].ip = dot2hex(newip);
                     EUCA_FREE(newip);
                 }
             }
-            vnetconfig->networks[vlan].numhosts++;
+            network->numhosts++;
         } else {
             LOGERROR("failed to convers mac address '%s on vlan %d'\n", mac, vlan);
         }
+        vnetSyncAddr(vnetconfig, vlan, found);
     } else {
         LOGERROR("failed to add host %s on vlan %d\n", mac, vlan);
         return (EUCA_ERROR);
@@ -902,6 +1189,7 @@ int vnetAddHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int idx)
 int vnetDelHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
 {
     int i = 0;
+    netEntry *addrs = NULL;
 
     if (param_check("vnetDelHost", vnetconfig, mac, ip, vlan)) {
         LOGERROR("bad input params: vnetconfig=%p, mac=%s, ip=%s, vlan=%d\n", vnetconfig, SP(mac), SP(ip), vlan);
@@ -913,10 +1201,14 @@ int vnetDelHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
         return (EUCA_PERMISSION_ERROR);
     }
 
+    if ((addrs = vnetGetAddrs(vnetconfig, vlan)) == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+
     for (i = vnetconfig->addrIndexMin; i <= vnetconfig->addrIndexMax; i++) {
-        if ((!mac || !machexcmp(mac, vnetconfig->networks[vlan].addrs[i].mac)) && (!ip || (vnetconfig->networks[vlan].addrs[i].ip == dot2hex(ip)))) {
-            bzero(&(vnetconfig->networks[vlan].addrs[i]), sizeof(netEntry));
+        if ((!mac || !machexcmp(mac, addrs[i].mac)) && (!ip || (addrs[i].ip == dot2hex(ip)))) {
+            bzero(&(addrs[i]), sizeof(netEntry));
             vnetconfig->networks[vlan].numhosts--;
+            vnetSyncAddr(vnetconfig, vlan, i);
             return (EUCA_OK);
         }
     }
@@ -953,6 +1245,7 @@ int vnetRefreshHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int
     int start = 0;
     int stop = 0;
     boolean done = FALSE;
+    netEntry *addrs = NULL;
 
     if ((vnetconfig == NULL) || ((mac == NULL) && (ip == NULL)) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS)) {
         LOGERROR("bad input params: vnetconfig=%p, mac=%s, ip=%s, vlan=%d, idx=%d\n", vnetconfig, SP(mac), SP(ip), vlan, idx);
@@ -975,16 +1268,17 @@ int vnetRefreshHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int
         return (EUCA_INVALID_ERROR);
     }
 
-    for (i = start, done = FALSE, found = 0; ((i <= stop) && !done); i++) {
+    addrs = vnetGetAddrs(vnetconfig, vlan);
+    for (i = start, done = FALSE, found = 0; ((addrs != NULL) && (i <= stop) && !done); i++) {
         if (ip) {
-            if (vnetconfig->networks[vlan].addrs[i].ip == dot2hex(ip)) {
+            if (addrs[i].ip == dot2hex(ip)) {
                 found = i;
                 done = TRUE;
             }
         }
 
         if (mac) {
-            if (!machexcmp(mac, vnetconfig->networks[vlan].addrs[i].mac)) {
+            if (!machexcmp(mac, addrs[i].mac)) {
                 found = i;
                 done = TRUE;
             }
@@ -995,12 +1289,13 @@ int vnetRefreshHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int
         return (vnetAddHost(vnetconfig, mac, ip, vlan, idx));
     } else {
         if (mac) {
-            mac2hex(mac, vnetconfig->networks[vlan].addrs[found].mac);
+            mac2hex(mac, addrs[found].mac);
         }
 
         if (ip) {
-            vnetconfig->networks[vlan].addrs[found].ip = dot2hex(ip);
+            addrs[found].ip = dot2hex(ip);
         }
+        vnetSyncAddr(vnetconfig, vlan, found);
     }
 
     return (EUCA_OK);
@@ -1029,6 +1324,7 @@ int vnetRefreshHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int
 int vnetEnableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
 {
     int i = 0;
+    netEntry *addrs = NULL;
 
     if (param_check("vnetEnableHost", vnetconfig, mac, ip, vlan)) {
         LOGERROR("bad input params: vnetconfig=%p, mac=%s, ip=%s, vlan=%d\n", vnetconfig, SP(mac), SP(ip), vlan);
@@ -1040,9 +1336,13 @@ int vnetEnableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
         return (EUCA_PERMISSION_ERROR);
     }
 
+    if ((addrs = vnetGetAddrs(vnetconfig, vlan)) == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+
     for (i = vnetconfig->addrIndexMin; i <= vnetconfig->addrIndexMax; i++) {
-        if ((!mac || !machexcmp(mac, vnetconfig->networks[vlan].addrs[i].mac)) && (!ip || (vnetconfig->networks[vlan].addrs[i].ip == dot2hex(ip)))) {
-            vnetconfig->networks[vlan].addrs[i].active = 1;
+        if ((!mac || !machexcmp(mac, addrs[i].mac)) && (!ip || (addrs[i].ip == dot2hex(ip)))) {
+            addrs[i].active = 1;
+            vnetSyncAddr(vnetconfig, vlan, i);
             return (EUCA_OK);
         }
     }
@@ -1073,6 +1373,7 @@ int vnetEnableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
 int vnetDisableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
 {
     int i = 0;
+    netEntry *addrs = NULL;
 
     if ((vnetconfig == NULL) || ((mac == NULL) && (ip == NULL)) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS)) {
         LOGERROR("bad input params: vnetconfig=%p, mac=%s, ip=%s, vlan=%d\n", vnetconfig, SP(mac), SP(ip), vlan);
@@ -1084,9 +1385,13 @@ int vnetDisableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan)
         return (EUCA_PERMISSION_ERROR);
     }
 
+    if ((addrs = vnetGetAddrs(vnetconfig, vlan)) == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+
     for (i = vnetconfig->addrIndexMin; i <= vnetconfig->addrIndexMax; i++) {
-        if ((!mac || !machexcmp(mac, vnetconfig->networks[vlan].addrs[i].mac)) && (!ip || (vnetconfig->networks[vlan].addrs[i].ip == dot2hex(ip)))) {
-            vnetconfig->networks[vlan].addrs[i].active = 0;
+        if ((!mac || !machexcmp(mac, addrs[i].mac)) && (!ip || (addrs[i].ip == dot2hex(ip)))) {
+            addrs[i].active = 0;
+            vnetSyncAddr(vnetconfig, vlan, i);
             return (EUCA_OK);
         }
     }
@@ -1290,7 +1595,8 @@ int vnetApplySingleTableRule(vnetConfig * vnetconfig, char *table, char *rule)
     int fd = 0;
     int ret = EUCA_OK;
     char *file = NULL;
-    char cmd[256] = "";
+    char rootwrap[EUCA_MAX_PATH] = "";
+    char helper[EUCA_MAX_PATH] = "";
     FILE *FH = NULL;
 
     if (!rule || !table || !vnetconfig) {
@@ -1323,8 +1629,9 @@ int vnetApplySingleTableRule(vnetConfig * vnetconfig, char *table, char *rule)
     fclose(FH);
     close(fd);
 
-    snprintf(cmd, 256, EUCALYPTUS_ROOTWRAP " " EUCALYPTUS_HELPER_DIR "/euca_ipt %s %s", vnetconfig->eucahome, vnetconfig->eucahome, table, file);
-    if ((rc = system(cmd)) != 0) {
+    snprintf(rootwrap, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, vnetconfig->eucahome);
+    snprintf(helper, EUCA_MAX_PATH, EUCALYPTUS_HELPER_DIR "/euca_ipt", vnetconfig->eucahome);
+    if ((rc = euca_execlp(NULL, rootwrap, helper, table, file, NULL)) != EUCA_OK) {
         ret = EUCA_ERROR;
     }
 
@@ -1604,6 +1911,7 @@ int vnetGenerateNetworkParams(vnetConfig * vnetconfig, char *instId, int vlan, i
     int networkIdx = 0;
     u32 inip = 0;
     boolean found = FALSE;
+    netEntry *addrs = NULL;
 
     if (!vnetconfig || !instId || !outmac || !outpubip || !outprivip) {
         LOGERROR("bad input params: vnetconfig=%p, instId=%s, outmac=%s, outpubip=%s outprivip=%s\n", vnetconfig, SP(instId), SP(outmac), SP(outpubip), SP(outprivip));
@@ -1617,9 +1925,11 @@ int vnetGenerateNetworkParams(vnetConfig * vnetconfig, char *instId, int vlan, i
         inip = dot2hex(outprivip);
         found = FALSE;
 
-        for (i = vnetconfig->addrIndexMin; ((i < vnetconfig->addrIndexMax) && !found); i++) {
-            if (!machexcmp(outmac, vnetconfig->networks[0].addrs[i].mac) && (vnetconfig->networks[0].addrs[i].ip == inip)) {
-                vnetconfig->networks[0].addrs[i].active = 1;
+        addrs = vnetGetAddrs(vnetconfig, 0);
+        for (i = vnetconfig->addrIndexMin; ((addrs != NULL) && (i < vnetconfig->addrIndexMax) && !found); i++) {
+            if (!machexcmp(outmac, addrs[i].mac) && (addrs[i].ip == inip)) {
+                addrs[i].active = 1;
+                vnetSyncAddr(vnetconfig, 0, i);
                 found = TRUE;
                 ret = EUCA_OK;
             }
@@ -1692,6 +2002,7 @@ int vnetGetNextHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int
     int stop = 0;
     char *newip = NULL;
     char *newmac = NULL;
+    netEntry *addrs = NULL;
 
     if (param_check("vnetGetNextHost", vnetconfig, mac, ip, vlan)) {
         LOGERROR("bad input params: vnetconfig=%p, mac=%s, ip=%s, vlan=%d\n", vnetconfig, SP(mac), SP(ip), vlan);
@@ -1714,17 +2025,20 @@ int vnetGetNextHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int
         return (EUCA_INVALID_ERROR);
     }
 
-    for (i = start; i <= stop; i++) {
-        if (maczero(vnetconfig->networks[vlan].addrs[i].mac) && (vnetconfig->networks[vlan].addrs[i].ip != 0) && (vnetconfig->networks[vlan].addrs[i].active == 0)) {
-            hex2mac(vnetconfig->networks[vlan].addrs[i].mac, &newmac);
-            strncpy(mac, newmac, strlen(newmac));
-            EUCA_FREE(newmac);
-            newip = hex2dot(vnetconfig->networks[vlan].addrs[i].ip);
-            strncpy(ip, newip, 16);
-            EUCA_FREE(newip);
-            vnetconfig->networks[vlan].addrs[i].active = 1;
-            return (EUCA_OK);
-        }
+    if ((addrs = vnetGetAddrs(vnetconfig, vlan)) == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    // the first host with a MAC and IP assigned that is not active yet
+    if ((i = vnetFindBit(vnetconfig->networks[vlan].readyAddrs, start, stop, TRUE)) >= 0) {
+        hex2mac(addrs[i].mac, &newmac);
+        strncpy(mac, newmac, strlen(newmac));
+        EUCA_FREE(newmac);
+        newip = hex2dot(addrs[i].ip);
+        strncpy(ip, newip, 16);
+        EUCA_FREE(newip);
+        addrs[i].active = 1;
+        vnetSyncAddr(vnetconfig, vlan, i);
+        return (EUCA_OK);
     }
     return (EUCA_NOT_FOUND_ERROR);
 }
@@ -1891,6 +2205,312 @@ int vnetDelDev(vnetConfig * vnetconfig, char *dev)
     return (EUCA_OK);
 }
 
+//!
+//! Gets the secret of the key the DHCP daemon takes OMAPI host updates with, making one
+//! up the first time around. The daemon listens for OMAPI on every interface, so it only
+//! accepts requests signed with this key.
+//!
+//! @param[in] path the directory the DHCP daemon files live in
+//!
+//! @return the secret, to be freed by the caller, or NULL if it cannot be read or made
+//!
+char *vnetGetDHCPOmapiSecret(char *path)
+{
+    int i = 0;
+    int fd = -1;
+    u8 rnd[VNET_DHCP_OMAPI_SECRET_LEN] = { 0 };
+    char file[EUCA_MAX_PATH] = "";
+    char secret[VNET_DHCP_OMAPI_SECRET_LEN + 1] = "";
+    char *ret = NULL;
+    struct stat mystat = { 0 };
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    if (!path) {
+        return (NULL);
+    }
+
+    snprintf(file, EUCA_MAX_PATH, "%s/euca-dhcp.omapi-key", path);
+    if ((stat(file, &mystat) == 0) && ((ret = file2str(file)) != NULL)) {
+        if (strlen(ret) == VNET_DHCP_OMAPI_SECRET_LEN) {
+            return (ret);
+        }
+        EUCA_FREE(ret);
+    }
+
+    // any run of base64 digits whose length is a multiple of 4 is a valid, unpadded secret
+    if ((fd = open("/dev/urandom", O_RDONLY)) < 0) {
+        LOGERROR("cannot open /dev/urandom to make up the DHCP OMAPI key\n");
+        return (NULL);
+    }
+    if (read(fd, rnd, VNET_DHCP_OMAPI_SECRET_LEN) != VNET_DHCP_OMAPI_SECRET_LEN) {
+        LOGERROR("cannot read /dev/urandom to make up the DHCP OMAPI key\n");
+        close(fd);
+        return (NULL);
+    }
+    close(fd);
+
+    for (i = 0; i < VNET_DHCP_OMAPI_SECRET_LEN; i++) {
+        secret[i] = b64[rnd[i] & 0x3f];
+    }
+
+    unlink(file);
+    if ((fd = open(file, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0) {
+        LOGERROR("cannot create DHCP OMAPI key file '%s'\n", file);
+        return (NULL);
+    }
+    if (write(fd, secret, VNET_DHCP_OMAPI_SECRET_LEN) != VNET_DHCP_OMAPI_SECRET_LEN) {
+        LOGERROR("cannot write DHCP OMAPI key file '%s'\n", file);
+        close(fd);
+        unlink(file);
+        return (NULL);
+    }
+    close(fd);
+
+    return (strdup(secret));
+}
+
+//!
+//! Writes the lines that have the DHCP daemon take OMAPI host updates into its config file.
+//! If no key can be had the daemon is left without OMAPI and every change restarts it.
+//!
+//! @param[in] fp the DHCP daemon config file being written
+//! @param[in] path the directory the DHCP daemon files live in
+//!
+void vnetPrintDHCPOmapiConf(FILE * fp, char *path)
+{
+    char *secret = NULL;
+
+    if (!fp || ((secret = vnetGetDHCPOmapiSecret(path)) == NULL)) {
+        return;
+    }
+
+    fprintf(fp, "key %s {\n  algorithm hmac-md5;\n  secret \"%s\";\n}\nomapi-key %s;\nomapi-port %d;\n\n", VNET_DHCP_OMAPI_KEY, secret, VNET_DHCP_OMAPI_KEY,
+            VNET_DHCP_OMAPI_PORT);
+    EUCA_FREE(secret);
+}
+
+//!
+//! Splits a DHCP daemon config file in its host entries and everything else
+//!
+//! @param[in,out] conf the content of a config file written by vnetGenerateDHCP() or the like; on return
+//!                it holds everything but the host entries
+//! @param[out]    outhosts the host entries, to be freed by the caller
+//! @param[out]    outmax number of host entries
+//!
+static void vnetSplitDHCPConf(char *conf, dhcpHostEntry ** outhosts, int *outmax)
+{
+    int len = 0;
+    char *in = NULL;
+    char *out = NULL;
+    char *start = NULL;
+    char *end = NULL;
+    char *field = NULL;
+    char block[1024] = "";
+    dhcpHostEntry *hosts = NULL;
+    dhcpHostEntry *host = NULL;
+
+    *outhosts = NULL;
+    *outmax = 0;
+
+    // the host blocks are taken out and what is around them is compacted in place
+    in = out = conf;
+    while (((start = strstr(in, "\nhost ")) != NULL) && ((end = strstr(start, "}\n")) != NULL)) {
+        end += 2;
+        memmove(out, in, (start - in));
+        out += (start - in);
+
+        len = (((end - start) < sizeof(block)) ? (end - start) : (sizeof(block) - 1));
+        memcpy(block, start, len);
+        block[len] = '\0';
+
+        if ((hosts = EUCA_REALLOC(*outhosts, (*outmax + 1), sizeof(dhcpHostEntry))) != NULL) {
+            *outhosts = hosts;
+            host = &(hosts[*outmax]);
+            bzero(host, sizeof(dhcpHostEntry));
+            sscanf(block, "\nhost %63s", host->name);
+            if ((field = strstr(block, "hardware ethernet ")) != NULL) {
+                sscanf(field, "hardware ethernet %23[^;]", host->mac);
+            }
+            if ((field = strstr(block, "fixed-address ")) != NULL) {
+                sscanf(field, "fixed-address %23[^;]", host->ip);
+            }
+            (*outmax)++;
+        }
+        in = end;
+    }
+    memmove(out, in, (strlen(in) + 1));
+}
+
+//!
+//! Looks a host entry up by name
+//!
+//! @param[in] hosts the host entries
+//! @param[in] max_hosts number of host entries
+//! @param[in] name the name of the host
+//!
+//! @return a pointer to the entry or NULL if there is none by that name
+//!
+static dhcpHostEntry *vnetFindDHCPHost(dhcpHostEntry * hosts, int max_hosts, char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < max_hosts; i++) {
+        if (!strcmp(hosts[i].name, name)) {
+            return (&(hosts[i]));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Brings the hosts a running DHCP daemon serves in line with its freshly written config file,
+//! through OMAPI, so that the daemon need not be restarted. This only works if nothing but
+//! host entries changed since the daemon was started with vnetRecordDHCPConf() called after.
+//!
+//! @param[in] path the directory the DHCP daemon files live in
+//!
+//! @return EUCA_OK if the daemon now serves what the config file says or EUCA_ERROR if the
+//!         daemon has to be restarted
+//!
+int vnetUpdateDHCPHosts(char *path)
+{
+    int i = 0;
+    int pid = 0;
+    int changes = 0;
+    int ret = EUCA_ERROR;
+    int max_curhosts = 0;
+    int max_newhosts = 0;
+    char conffile[EUCA_MAX_PATH] = "";
+    char livefile[EUCA_MAX_PATH] = "";
+    char pidfile[EUCA_MAX_PATH] = "";
+    char scriptfile[EUCA_MAX_PATH] = "";
+    char cmd[EUCA_MAX_PATH] = "";
+    char *newconf = NULL;
+    char *newrest = NULL;
+    char *curconf = NULL;
+    char *secret = NULL;
+    char *pidstr = NULL;
+    char *output = NULL;
+    FILE *FH = NULL;
+    struct stat mystat = { 0 };
+    dhcpHostEntry *curhosts = NULL;
+    dhcpHostEntry *newhosts = NULL;
+    dhcpHostEntry *host = NULL;
+
+    if (!path) {
+        return (EUCA_ERROR);
+    }
+
+    snprintf(conffile, EUCA_MAX_PATH, "%s/euca-dhcp.conf", path);
+    snprintf(livefile, EUCA_MAX_PATH, "%s/euca-dhcp.conf.live", path);
+    snprintf(pidfile, EUCA_MAX_PATH, "%s/euca-dhcp.pid", path);
+    snprintf(scriptfile, EUCA_MAX_PATH, "%s/euca-dhcp.omshell", path);
+
+    // there has to be a daemon running off this config file that we know the state of
+    if ((stat(pidfile, &mystat) == 0) && ((pidstr = file2str(pidfile)) != NULL)) {
+        pid = atoi(pidstr);
+        EUCA_FREE(pidstr);
+    }
+    if ((pid <= 1) || check_process(pid, conffile) || (stat(livefile, &mystat) != 0)) {
+        return (EUCA_ERROR);
+    }
+    if (((curconf = file2str(livefile)) == NULL) || ((newconf = file2str(conffile)) == NULL) || ((secret = vnetGetDHCPOmapiSecret(path)) == NULL)) {
+        EUCA_FREE(curconf);
+        EUCA_FREE(newconf);
+        return (EUCA_ERROR);
+    }
+
+    newrest = strdup(newconf);
+    vnetSplitDHCPConf(curconf, &curhosts, &max_curhosts);
+    vnetSplitDHCPConf(newrest, &newhosts, &max_newhosts);
+
+    if (strcmp(curconf, newrest)) {
+        // subnets, options or the like changed, those take a restart
+        LOGDEBUG("DHCP config changed beyond host entries, daemon needs a restart\n");
+    } else if ((FH = fopen(scriptfile, "w")) == NULL) {
+        LOGERROR("cannot open DHCP OMAPI script file for write '%s': check permissions\n", scriptfile);
+    } else {
+        fprintf(FH, "key %s %s\nserver 127.0.0.1\nport %d\nconnect\n", VNET_DHCP_OMAPI_KEY, secret, VNET_DHCP_OMAPI_PORT);
+
+        // hosts that went away or were given another address go first
+        for (i = 0; i < max_curhosts; i++) {
+            host = vnetFindDHCPHost(newhosts, max_newhosts, curhosts[i].name);
+            if (!host || strcmp(host->mac, curhosts[i].mac) || strcmp(host->ip, curhosts[i].ip)) {
+                fprintf(FH, "new host\nset name = \"%s\"\nopen\nremove\n", curhosts[i].name);
+                changes++;
+            }
+        }
+        for (i = 0; i < max_newhosts; i++) {
+            host = vnetFindDHCPHost(curhosts, max_curhosts, newhosts[i].name);
+            if (!host || strcmp(host->mac, newhosts[i].mac) || strcmp(host->ip, newhosts[i].ip)) {
+                fprintf(FH, "new host\nset name = \"%s\"\nset hardware-address = %s\nset hardware-type = 1\nset ip-address = %s\ncreate\n", newhosts[i].name,
+                        newhosts[i].mac, newhosts[i].ip);
+                changes++;
+            }
+        }
+        fclose(FH);
+
+        if (!changes) {
+            ret = EUCA_OK;
+        } else {
+            // omshell does not fail on a rejected request, it only says so
+            snprintf(cmd, EUCA_MAX_PATH, "omshell < %s 2>&1", scriptfile);
+            LOGDEBUG("pushing %d DHCP host change(s) through OMAPI\n", changes);
+            output = system_output(cmd);
+            if (output && !strstr(output, "can't") && !strstr(output, "not connected") && !strstr(output, "not found") && !strstr(output, "invalid")) {
+                ret = EUCA_OK;
+            } else {
+                LOGWARN("could not push DHCP host changes through OMAPI, daemon needs a restart: %s\n", SP(output));
+            }
+            EUCA_FREE(output);
+        }
+        unlink(scriptfile);
+
+        if ((ret == EUCA_OK) && changes) {
+            // what the daemon serves now is what the new config file says
+            if ((FH = fopen(livefile, "w")) != NULL) {
+                fputs(newconf, FH);
+                fclose(FH);
+            } else {
+                unlink(livefile);
+            }
+        }
+    }
+
+    EUCA_FREE(curhosts);
+    EUCA_FREE(newhosts);
+    EUCA_FREE(curconf);
+    EUCA_FREE(newconf);
+    EUCA_FREE(newrest);
+    EUCA_FREE(secret);
+    return (ret);
+}
+
+//!
+//! Records the config file a DHCP daemon was just started with, as the base that
+//! vnetUpdateDHCPHosts() later pushes host changes against
+//!
+//! @param[in] path the directory the DHCP daemon files live in
+//!
+void vnetRecordDHCPConf(char *path)
+{
+    char conffile[EUCA_MAX_PATH] = "";
+    char livefile[EUCA_MAX_PATH] = "";
+    char *conf = NULL;
+    FILE *FH = NULL;
+
+    snprintf(conffile, EUCA_MAX_PATH, "%s/euca-dhcp.conf", path);
+    snprintf(livefile, EUCA_MAX_PATH, "%s/euca-dhcp.conf.live", path);
+    unlink(livefile);
+    if (((conf = file2str(conffile)) == NULL) || ((FH = fopen(livefile, "w")) == NULL)) {
+        LOGWARN("cannot record DHCP config as started, host changes will restart the daemon\n");
+    } else {
+        fputs(conf, FH);
+        fclose(FH);
+    }
+    EUCA_FREE(conf);
+}
+
 //!
 //!
 //!
@@ -1921,6 +2541,7 @@ int vnetGenerateDHCP(vnetConfig * vnetconfig, int *numHosts)
     char nameservers[1024] = "";
     char fname[EUCA_MAX_PATH] = "";
     FILE *fp = NULL;
+    netEntry *addrs = NULL;
     boolean hasNameServer = FALSE;
 
     if (param_check("vnetGenerateDHCP", vnetconfig) || (numHosts == NULL)) {
@@ -1935,6 +2556,7 @@ int vnetGenerateDHCP(vnetConfig * vnetconfig, int *numHosts)
         return (EUCA_ACCESS_ERROR);
     }
     fprintf(fp, "# automatically generated config file for DHCP server\ndefault-lease-time 86400;\nmax-lease-time 86400;\nddns-update-style none;\n\n");
+    vnetPrintDHCPOmapiConf(fp, vnetconfig->path);
 
     fprintf(fp, "shared-network euca {\n");
     for (i = 0; i < vnetconfig->max_vlan; i++) {
@@ -1996,10 +2618,13 @@ int vnetGenerateDHCP(vnetConfig * vnetconfig, int *numHosts)
             EUCA_FREE(broadcast);
             EUCA_FREE(router);
 
-            for (j = vnetconfig->addrIndexMin; j <= vnetconfig->addrIndexMax; j++) {
-                if (vnetconfig->networks[i].addrs[j].active == 1) {
-                    newip = hex2dot(vnetconfig->networks[i].addrs[j].ip);
-                    hex2mac(vnetconfig->networks[i].addrs[j].mac, &mac);
+            // only the host indexes that have a MAC assigned get an entry
+            addrs = vnetGetAddrs(vnetconfig, i);
+            for (j = vnetFindBit(vnetconfig->networks[i].freeAddrs, vnetconfig->addrIndexMin, vnetconfig->addrIndexMax, FALSE);
+                 ((addrs != NULL) && (j >= 0)); j = vnetFindBit(vnetconfig->networks[i].freeAddrs, (j + 1), vnetconfig->addrIndexMax, FALSE)) {
+                if (addrs[j].active == 1) {
+                    newip = hex2dot(addrs[j].ip);
+                    hex2mac(addrs[j].mac, &mac);
                     fprintf(fp, "\nhost node-%s {\n  hardware ethernet %s;\n  fixed-address %s;\n}\n", newip, mac, newip);
                     (*numHosts)++;
                     EUCA_FREE(mac);
@@ -2055,6 +2680,12 @@ int vnetKickDHCP(vnetConfig * vnetconfig)
         return (EUCA_OK);
     }
 
+    // when only hosts came or went, the running daemon takes them without a restart
+    if (vnetUpdateDHCPHosts(vnetconfig->path) == EUCA_OK) {
+        LOGDEBUG("DHCP daemon host entries updated in place\n");
+        return (EUCA_OK);
+    }
+
     for (i = 0; i < vnetconfig->max_vlan; i++) {
         if (vnetconfig->etherdevs[i][0] != '\0') {
             strncat(dstring, " ", EUCA_MAX_PATH - 1);
@@ -2096,8 +2727,10 @@ int vnetKickDHCP(vnetConfig * vnetconfig)
     snprintf(buf, EUCA_MAX_PATH, "%s/euca-dhcp.trace", vnetconfig->path);
     unlink(buf);
 
+    // the hosts all have fixed addresses, so all the lease file holds is the host entries that came
+    // and went through OMAPI, none of which the new daemon should pick up over its config file
     snprintf(buf, EUCA_MAX_PATH, "%s/euca-dhcp.leases", vnetconfig->path);
-    if ((rc = open(buf, O_WRONLY | O_CREAT, 0644)) != -1) {
+    if ((rc = open(buf, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1) {
         close(rc);
     } else {
         if (check_file(buf)) {
@@ -2122,6 +2755,9 @@ int vnetKickDHCP(vnetConfig * vnetconfig)
     // cannot use 'daemonrun()' here, dhcpd3 is too picky about FDs and signal handlers...
     rc = system(buf);
     LOGTRACE("RC from cmd: %d\n", rc);
+    if (rc == 0) {
+        vnetRecordDHCPConf(vnetconfig->path);
+    }
     return (rc);
 }
 
@@ -2185,8 +2821,13 @@ int vnetDelCCS(vnetConfig * vnetconfig, u32 cc)
         if (vnetconfig->tunnels.ccs[i] == cc) {
             // bring down the tunnel
 
-            snprintf(file, EUCA_MAX_PATH, EUCALYPTUS_RUN_DIR "/vtund-client-%d-%d.pid", vnetconfig->eucahome, vnetconfig->tunnels.localIpId, i);
-            rc = safekillfile(file, "vtund", 9, rootwrap);
+            if (vnetconfig->tunnels.mode == TUNNEL_VTUN) {
+                snprintf(file, EUCA_MAX_PATH, EUCALYPTUS_RUN_DIR "/vtund-client-%d-%d.pid", vnetconfig->eucahome, vnetconfig->tunnels.localIpId, i);
+                rc = safekillfile(file, "vtund", 9, rootwrap);
+            } else if ((vnetconfig->tunnels.localIpId >= 0) && (vnetconfig->tunnels.localIpId != i)) {
+                snprintf(file, EUCA_MAX_PATH, "tap-%d-%d", vnetconfig->tunnels.localIpId, i);
+                rc = vnetLinkDelTunnel(vnetconfig, file);
+            }
 
             vnetconfig->tunnels.ccs[i] = 0;
             return (EUCA_OK);
@@ -2284,6 +2925,7 @@ int vnetStartNetworkManaged(vnetConfig * vnetconfig, int vlan, char *uuid, char
     char cmd[EUCA_MAX_PATH] = "";
     char newdevname[32] = "";
     char newbrname[32] = "";
+    netEntry *addrs = NULL;
 
     // check input params...
     if (!vnetconfig || !outbrname) {
@@ -2309,8 +2951,7 @@ int vnetStartNetworkManaged(vnetConfig * vnetconfig, int vlan, char *uuid, char
         if (!strcmp(vnetconfig->mode, NETMODE_MANAGED)) {
             snprintf(newdevname, 32, "%s.%d", vnetconfig->privInterface, vlan);
             if ((rc = check_device(newdevname)) != 0) {
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig add %s %d", vnetconfig->eucahome, vnetconfig->privInterface, vlan);
-                if ((rc = system(cmd)) != 0) {
+                if ((rc = vnetLinkAddVlan(vnetconfig, vnetconfig->privInterface, vlan)) != EUCA_OK) {
                     // failed to create vlan tagged device
                     LOGERROR("cannot create new vlan device %s.%d\n", vnetconfig->privInterface, vlan);
                     return (EUCA_ERROR);
@@ -2320,25 +2961,21 @@ int vnetStartNetworkManaged(vnetConfig * vnetconfig, int vlan, char *uuid, char
             snprintf(newbrname, 32, "eucabr%d", vlan);
             if ((rc = check_bridge(newbrname)) != 0) {
                 // bridge does not yet exist
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl addbr %s", vnetconfig->eucahome, newbrname);
-                if ((rc = system(cmd)) != 0) {
+                if ((rc = vnetLinkAddBridge(vnetconfig, newbrname, FALSE)) != EUCA_OK) {
                     LOGERROR("could not create new bridge %s\n", newbrname);
                     return (EUCA_ERROR);
                 }
             }
             // add if to bridge
-            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl addif %s %s", vnetconfig->eucahome, newbrname, newdevname);
-            rc = system(cmd);
+            rc = vnetLinkSetMaster(vnetconfig, newbrname, newdevname);
 
             // bring br up
             if (check_deviceup(newbrname)) {
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s up", vnetconfig->eucahome, newbrname);
-                rc = system(cmd);
+                rc = vnetLinkSetUp(vnetconfig, newbrname, TRUE);
             }
             // bring if up
             if (check_deviceup(newdevname)) {
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s up", vnetconfig->eucahome, newdevname);
-                rc = system(cmd);
+                rc = vnetLinkSetUp(vnetconfig, newdevname, TRUE);
             }
         } else {
             snprintf(newbrname, 32, "%s", vnetconfig->bridgedev);
@@ -2346,12 +2983,19 @@ int vnetStartNetworkManaged(vnetConfig * vnetconfig, int vlan, char *uuid, char
 
         *outbrname = strdup(newbrname);
     } else if ((vlan > 0) && ((vnetconfig->role == CC) || (vnetconfig->role == CLC))) {
+        if ((addrs = vnetAllocAddrs(vnetconfig, vlan)) == NULL) {
+            LOGERROR("cannot allocate host entries for vlan %d\n", vlan);
+            return (EUCA_ERROR);
+        }
+
         vnetconfig->networks[vlan].active = 1;
         vnetconfig->networks[vlan].createTime = time(NULL);
         for (i = 0; i <= NUMBER_OF_CCS; i++) {
-            vnetconfig->networks[vlan].addrs[i].active = 1;
+            addrs[i].active = 1;
+            vnetSyncAddr(vnetconfig, vlan, i);
         }
-        vnetconfig->networks[vlan].addrs[vnetconfig->numaddrs - 1].active = 1;
+        addrs[vnetconfig->addrBlockSize - 1].active = 1;
+        vnetSyncAddr(vnetconfig, vlan, (vnetconfig->addrBlockSize - 1));
 
         rc = vnetSetVlan(vnetconfig, vlan, uuid, userName, netName);
         rc = vnetCreateChain(vnetconfig, userName, netName);
@@ -2366,54 +3010,33 @@ int vnetStartNetworkManaged(vnetConfig * vnetconfig, int vlan, char *uuid, char
         if (!strcmp(vnetconfig->mode, NETMODE_MANAGED)) {
             snprintf(newdevname, 32, "%s.%d", vnetconfig->privInterface, vlan);
             if ((rc = check_device(newdevname)) != 0) {
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig add %s %d", vnetconfig->eucahome, vnetconfig->privInterface, vlan);
-                if ((rc = system(cmd)) != 0) {
+                if ((rc = vnetLinkAddVlan(vnetconfig, vnetconfig->privInterface, vlan)) != EUCA_OK) {
                     LOGERROR("could not tag %s with vlan %d\n", vnetconfig->privInterface, vlan);
                     return (EUCA_ERROR);
                 }
             }
-            // create new bridge
+            // create new bridge, with STP off and short timers (DAN temporary)
             snprintf(newbrname, 32, "eucabr%d", vlan);
             if ((rc = check_bridge(newbrname)) != 0) {
                 // bridge does not yet exist
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl addbr %s", vnetconfig->eucahome, newbrname);
-                if ((rc = system(cmd)) != 0) {
+                if ((rc = vnetLinkAddBridge(vnetconfig, newbrname, TRUE)) != EUCA_OK) {
                     LOGERROR("could not create new bridge %s\n", newbrname);
                     return (EUCA_ERROR);
                 }
-                // DAN temporary
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl stp %s off", vnetconfig->eucahome, newbrname);
-                if ((rc = system(cmd)) != 0) {
-                    LOGWARN("could not enable stp on bridge %s\n", newbrname);
-                }
+            }
 
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl setfd %s 2", vnetconfig->eucahome, newbrname);
-                if ((rc = system(cmd)) != 0) {
-                    LOGWARN("could not set fd time to 2 on bridge %s\n", newbrname);
-                }
-
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl sethello %s 2", vnetconfig->eucahome, newbrname);
-                if ((rc = system(cmd)) != 0) {
-                    LOGWARN("could not set hello time to 2 on bridge %s\n", newbrname);
-                }
-            }
-
-            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl addif %s %s", vnetconfig->eucahome, newbrname, newdevname);
-            rc = system(cmd);
+            rc = vnetLinkSetMaster(vnetconfig, newbrname, newdevname);
 
             // bring br up
             if (check_deviceup(newbrname)) {
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s up", vnetconfig->eucahome, newbrname);
-                rc = system(cmd);
+                rc = vnetLinkSetUp(vnetconfig, newbrname, TRUE);
             }
 
-            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip addr flush %s", vnetconfig->eucahome, newbrname);
-            rc = system(cmd);
+            rc = vnetAddrFlush(vnetconfig, newbrname);
 
             // bring if up
             if (check_deviceup(newdevname)) {
-                snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s up", vnetconfig->eucahome, newdevname);
-                rc = system(cmd);
+                rc = vnetLinkSetUp(vnetconfig, newdevname, TRUE);
             }
             // attach tunnel(s)
             if ((rc = vnetAttachTunnels(vnetconfig, vlan, newbrname)) != 0) {
@@ -2456,7 +3079,6 @@ int vnetAttachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
 {
     int rc = 0;
     int i = 0;
-    char cmd[EUCA_MAX_PATH] = "";
     char tundev[32] = "";
     char tunvlandev[32] = "";
 
@@ -2475,8 +3097,7 @@ int vnetAttachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
     }
 
     if (check_bridgestp(newbrname)) {
-        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl stp %s on", vnetconfig->eucahome, newbrname);
-        if ((rc = system(cmd)) != 0) {
+        if ((rc = vnetBridgeSetStp(vnetconfig, newbrname, TRUE)) != EUCA_OK) {
             LOGWARN("could enable stp on bridge %s\n", newbrname);
         }
     }
@@ -2489,27 +3110,18 @@ int vnetAttachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
                     if (!strcmp(vnetconfig->mode, NETMODE_MANAGED)) {
                         snprintf(tunvlandev, 32, "tap-%d-%d.%d", vnetconfig->tunnels.localIpId, i, vlan);
                         if (check_device(tunvlandev)) {
-                            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig add %s %d", vnetconfig->eucahome, tundev, vlan);
-                            LOGDEBUG("running cmd '%s'\n", cmd);
-                            rc = system(cmd);
-                            rc = rc >> 8;
+                            rc = vnetLinkAddVlan(vnetconfig, tundev, vlan);
                         }
                     } else {
                         snprintf(tunvlandev, 32, "%s", tundev);
                     }
 
                     if (check_bridgedev(newbrname, tunvlandev)) {
-                        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl addif %s %s", vnetconfig->eucahome, newbrname, tunvlandev);
-                        LOGDEBUG("running cmd '%s'\n", cmd);
-                        rc = system(cmd);
-                        rc = rc >> 8;
+                        rc = vnetLinkSetMaster(vnetconfig, newbrname, tunvlandev);
                     }
 
                     if (check_deviceup(tunvlandev)) {
-                        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set up dev %s", vnetconfig->eucahome, tunvlandev);
-                        LOGDEBUG("running cmd '%s'\n", cmd);
-                        rc = system(cmd);
-                        rc = rc >> 8;
+                        rc = vnetLinkSetUp(vnetconfig, tunvlandev, TRUE);
                     }
                 }
 
@@ -2518,27 +3130,18 @@ int vnetAttachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
                     if (!strcmp(vnetconfig->mode, NETMODE_MANAGED)) {
                         snprintf(tunvlandev, 32, "tap-%d-%d.%d", i, vnetconfig->tunnels.localIpId, vlan);
                         if (check_device(tunvlandev)) {
-                            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig add %s %d", vnetconfig->eucahome, tundev, vlan);
-                            LOGDEBUG("running cmd '%s'\n", cmd);
-                            rc = system(cmd);
-                            rc = rc >> 8;
+                            rc = vnetLinkAddVlan(vnetconfig, tundev, vlan);
                         }
                     } else {
                         snprintf(tunvlandev, 32, "%s", tundev);
                     }
 
                     if (check_bridgedev(newbrname, tunvlandev)) {
-                        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " brctl addif %s %s", vnetconfig->eucahome, newbrname, tunvlandev);
-                        LOGDEBUG("running cmd '%s'\n", cmd);
-                        rc = system(cmd);
-                        rc = rc >> 8;
+                        rc = vnetLinkSetMaster(vnetconfig, newbrname, tunvlandev);
                     }
 
                     if (check_deviceup(tunvlandev)) {
-                        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set up dev %s", vnetconfig->eucahome, tunvlandev);
-                        LOGDEBUG("running cmd '%s'\n", cmd);
-                        rc = system(cmd);
-                        rc = rc >> 8;
+                        rc = vnetLinkSetUp(vnetconfig, tunvlandev, TRUE);
                     }
                 }
             }
@@ -2578,7 +3181,9 @@ int vnetDetachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
     slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->networks[vlan].nm)) + 1);
     network = hex2dot(vnetconfig->networks[vlan].nw);
     snprintf(cmd, EUCA_MAX_PATH, "-D FORWARD -s %s/%d -d %s/%d -j ACCEPT", network, slashnet, network, slashnet);
-    rc = vnetApplySingleTableRule(vnetconfig, "filter", cmd);
+    if ((rc = vnetApplySingleTableRule(vnetconfig, "filter", cmd)) != 0) {
+        LOGWARN("could not remove forwarding rule for network %s/%d\n", network, slashnet);
+    }
     EUCA_FREE(network);
 
     for (i = 0; i < NUMBER_OF_CCS; i++) {
@@ -2586,22 +3191,16 @@ int vnetDetachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
             snprintf(tundev, 32, "tap-%d-%d", vnetconfig->tunnels.localIpId, i);
             if (!check_device(tundev) && !check_device(newbrname)) {
                 snprintf(tunvlandev, 32, "tap-%d-%d.%d", vnetconfig->tunnels.localIpId, i, vlan);
-                if (!check_device(tunvlandev)) {
-                    snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig rem %s", vnetconfig->eucahome, tunvlandev);
-                    LOGDEBUG("running cmd '%s'\n", cmd);
-                    rc = system(cmd);
-                    rc = rc >> 8;
+                if (!check_device(tunvlandev) && ((rc = vnetLinkDelVlan(vnetconfig, tunvlandev)) != EUCA_OK)) {
+                    LOGWARN("could not remove tunnel vlan device %s\n", tunvlandev);
                 }
             }
 
             snprintf(tundev, 32, "tap-%d-%d", i, vnetconfig->tunnels.localIpId);
             if (!check_device(tundev) && !check_device(newbrname)) {
                 snprintf(tunvlandev, 32, "tap-%d-%d.%d", i, vnetconfig->tunnels.localIpId, vlan);
-                if (!check_device(tunvlandev)) {
-                    snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig rem %s", vnetconfig->eucahome, tunvlandev);
-                    LOGDEBUG("running cmd '%s'\n", cmd);
-                    rc = system(cmd);
-                    rc = rc >> 8;
+                if (!check_device(tunvlandev) && ((rc = vnetLinkDelVlan(vnetconfig, tunvlandev)) != EUCA_OK)) {
+                    LOGWARN("could not remove tunnel vlan device %s\n", tunvlandev);
                 }
             }
         }
@@ -2615,12 +3214,15 @@ int vnetDetachTunnels(vnetConfig * vnetconfig, int vlan, char *newbrname)
 //!
 //! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
 //!
-//! @return the results of the vnetTeardownTunnelsVTUN() call.
+//! @return the results of the vnetTeardownTunnelsVTUN() or vnetTeardownTunnelsKernel() call,
+//!         depending on the tunnel mode.
 //!
-//! @see vnetTeardownTunnelsVTUN()
+//! @see vnetTeardownTunnelsVTUN(), vnetTeardownTunnelsKernel()
 //!
 int vnetTeardownTunnels(vnetConfig * vnetconfig)
 {
+    if (vnetconfig && (vnetconfig->tunnels.mode != TUNNEL_VTUN))
+        return (vnetTeardownTunnelsKernel(vnetconfig));
     return (vnetTeardownTunnelsVTUN(vnetconfig));
 }
 
@@ -2660,20 +3262,104 @@ int vnetTeardownTunnelsVTUN(vnetConfig * vnetconfig)
     return (EUCA_OK);
 }
 
+//!
+//! Removes the kernel tunnel devices to the other CCs. Any tap-<a>-<b> device goes, so the
+//! tunnels built under a previous local identifier do not linger.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//!
+//! @return EUCA_OK on succes or EUCA_INVALID_ERROR if any parameter does not meet the preconditions
+//!
+//! @pre \p vnetconfig must not be NULL.
+//!
+int vnetTeardownTunnelsKernel(vnetConfig * vnetconfig)
+{
+    int i = 0;
+    int j = 0;
+    char tundev[32] = "";
+
+    if (vnetconfig == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    for (i = 0; i < NUMBER_OF_CCS; i++) {
+        for (j = 0; j < NUMBER_OF_CCS; j++) {
+            snprintf(tundev, 32, "tap-%d-%d", i, j);
+            if ((i != j) && !check_device(tundev)) {
+                if (vnetLinkDelTunnel(vnetconfig, tundev) != EUCA_OK) {
+                    LOGWARN("could not remove tunnel device %s\n", tundev);
+                }
+            }
+        }
+    }
+    return (EUCA_OK);
+}
+
 //!
 //!
 //!
 //! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
 //!
-//! @return the result of the vnetSetupTunnelsVTUN() call
+//! @return the result of the vnetSetupTunnelsVTUN() or vnetSetupTunnelsKernel() call, depending
+//!         on the tunnel mode
 //!
-//! @see vnetSetupTunnelsVTUN()
+//! @see vnetSetupTunnelsVTUN(), vnetSetupTunnelsKernel()
 //!
 int vnetSetupTunnels(vnetConfig * vnetconfig)
 {
+    if (vnetconfig && (vnetconfig->tunnels.mode != TUNNEL_VTUN))
+        return (vnetSetupTunnelsKernel(vnetconfig));
     return (vnetSetupTunnelsVTUN(vnetconfig));
 }
 
+//!
+//! Creates the missing kernel tunnel devices to the other CCs. The one to CC <i> is named
+//! tap-<localIpId>-<i>, like the device of a vtund client, so vnetAttachTunnels() stacks the
+//! VLAN interfaces of the networks on it and adds them to the bridges the same way.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if any parameter does not meet the preconditions
+//!
+//! @pre \p vnetconfig must not be NULL
+//!
+int vnetSetupTunnelsKernel(vnetConfig * vnetconfig)
+{
+    int i = 0;
+    char tundev[32] = "";
+    char *remoteIp = NULL;
+
+    if (vnetconfig == NULL) {
+        LOGERROR("bad input params: vnetconfig=%p\n", vnetconfig);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (!vnetconfig->tunnels.tunneling || (vnetconfig->tunnels.localIpId == -1)) {
+        return (EUCA_OK);
+    }
+
+    for (i = 0; i < NUMBER_OF_CCS; i++) {
+        if ((vnetconfig->tunnels.ccs[i] != 0) && (vnetconfig->tunnels.localIpId != i)) {
+            snprintf(tundev, 32, "tap-%d-%d", vnetconfig->tunnels.localIpId, i);
+            if (check_device(tundev)) {
+                remoteIp = hex2dot(vnetconfig->tunnels.ccs[i]);
+                LOGDEBUG("creating tunnel device %s for endpoint: %s\n", tundev, remoteIp);
+                if (vnetLinkAddTunnel(vnetconfig, tundev, vnetconfig->tunnels.localIpId, i) != EUCA_OK) {
+                    LOGERROR("cannot create tunnel device %s for endpoint: %s\n", tundev, remoteIp);
+                }
+                EUCA_FREE(remoteIp);
+            }
+
+            if (!check_device(tundev) && check_deviceup(tundev)) {
+                if (vnetLinkSetUp(vnetconfig, tundev, TRUE) != EUCA_OK) {
+                    LOGERROR("could not bring up tunnel device %s\n", tundev);
+                }
+            }
+        }
+    }
+
+    return (EUCA_OK);
+}
+
 //!
 //!
 //!
@@ -2756,7 +3442,6 @@ int vnetAddGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int local
     char *broadcast = NULL;
     int rc = 0;
     int slashnet = 0;
-    char cmd[EUCA_MAX_PATH] = "";
 
     if ((vnetconfig == NULL) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS)) {
         LOGERROR("bad input params: vnetconfig=%p vlan=%d, devname=%s, lovalIpId=%d\n", vnetconfig, vlan, SP(devname), localIpId);
@@ -2773,12 +3458,7 @@ int vnetAddGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int local
     LOGDEBUG("adding gateway IP: %s\n", newip);
 
     slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->networks[vlan].nm)) + 1);
-    snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip addr add %s/%d broadcast %s dev %s", vnetconfig->eucahome, newip, slashnet, broadcast, devname);
-
-    LOGDEBUG("running cmd '%s'\n", cmd);
-    rc = system(cmd);
-    rc = rc >> 8;
-    if (rc && (rc != 2)) {
+    if ((rc = vnetAddrChange(vnetconfig, TRUE, devname, vnetconfig->networks[vlan].router + localIpId, slashnet, vnetconfig->networks[vlan].bc)) != EUCA_OK) {
         LOGERROR("could not bring up new device %s with ip %s\n", devname, newip);
         EUCA_FREE(newip);
         EUCA_FREE(broadcast);
@@ -2788,10 +3468,7 @@ int vnetAddGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int local
     EUCA_FREE(broadcast);
 
     if (check_deviceup(devname)) {
-        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s up", vnetconfig->eucahome, devname);
-        rc = system(cmd);
-        rc = rc >> 8;
-        if (rc) {
+        if ((rc = vnetLinkSetUp(vnetconfig, devname, TRUE)) != EUCA_OK) {
             LOGERROR("could not bring up interface '%s'\n", devname);
             return (EUCA_ERROR);
         }
@@ -2824,7 +3501,6 @@ int vnetDelGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int local
     int slashnet = 0;
     char *newip = NULL;
     char *broadcast = NULL;
-    char cmd[EUCA_MAX_PATH] = "";
 
     if ((vnetconfig == NULL) || (vlan < 0) || (vlan >= NUMBER_OF_VLANS) || (devname == NULL)) {
         LOGERROR("bad input params: vnetconfig=%p, vlan=%d, devname=%s, localIpId=%d\n", vnetconfig, vlan, SP(devname), localIpId);
@@ -2840,8 +3516,7 @@ int vnetDelGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int local
     broadcast = hex2dot(vnetconfig->networks[vlan].bc);
     LOGDEBUG("removing gateway IP: %s\n", newip);
     slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->networks[vlan].nm)) + 1);
-    snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip addr del %s/%d broadcast %s dev %s", vnetconfig->eucahome, newip, slashnet, broadcast, devname);
-    if ((rc = system(cmd)) != 0) {
+    if ((rc = vnetAddrChange(vnetconfig, FALSE, devname, vnetconfig->networks[vlan].router + localIpId, slashnet, vnetconfig->networks[vlan].bc)) != EUCA_OK) {
         LOGERROR("could not bring down new device %s with ip %s\n", devname, newip);
         ret = EUCA_ERROR;
     }
@@ -2889,27 +3564,24 @@ int vnetStopNetworkManaged(vnetConfig * vnetconfig, int vlan, char *userName, ch
     }
 
     vnetconfig->networks[vlan].active = 0;
-    bzero(vnetconfig->networks[vlan].addrs, sizeof(netEntry) * NUMBER_OF_HOSTS_PER_VLAN);
+    vnetFreeAddrs(vnetconfig, vlan);
 
     if (!strcmp(vnetconfig->mode, NETMODE_MANAGED)) {
         snprintf(newbrname, 32, "eucabr%d", vlan);
-        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s down", vnetconfig->eucahome, newbrname);
-        if ((rc = system(cmd)) != 0) {
-            LOGERROR("cmd '%s' failed\n", cmd);
+        if ((rc = vnetLinkSetUp(vnetconfig, newbrname, FALSE)) != EUCA_OK) {
+            LOGERROR("could not bring down %s\n", newbrname);
             ret = EUCA_ERROR;
         }
         // DAN temporary for QA, re-enable for release
         snprintf(newdevname, 32, "%s.%d", vnetconfig->privInterface, vlan);
         if ((rc = check_device(newdevname)) == 0) {
-            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip link set dev %s down", vnetconfig->eucahome, newdevname);
-            if ((rc = system(cmd)) != 0) {
-                LOGERROR("cmd '%s' failed\n", cmd);
+            if ((rc = vnetLinkSetUp(vnetconfig, newdevname, FALSE)) != EUCA_OK) {
+                LOGERROR("could not bring down %s\n", newdevname);
                 ret = EUCA_ERROR;
             }
 
-            snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " vconfig rem %s", vnetconfig->eucahome, newdevname);
-            if ((rc = system(cmd)) != 0) {
-                LOGERROR("cmd '%s' failed\n", cmd);
+            if ((rc = vnetLinkDelVlan(vnetconfig, newdevname)) != EUCA_OK) {
+                LOGERROR("could not remove vlan device %s\n", newdevname);
                 ret = EUCA_ERROR;
             }
         }
@@ -3006,6 +3678,101 @@ int vnetStartNetwork(vnetConfig * vnetconfig, int vlan, char *uuid, char *userNa
     return (rc);
 }
 
+//!
+//! Hashes a public IP to its bucket in vnetConfig publicipHash[]
+//!
+//! @param[in] ip the public IP in host byte order
+//!
+//! @return the bucket index
+//!
+static u32 vnetPublicIPBucket(u32 ip)
+{
+    return ((ip * 2654435761U) >> (32 - VNET_PUBIP_HASH_BITS));
+}
+
+//!
+//! Looks up the slot of a public IP in our pool
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] ip the public IP to look for
+//!
+//! @return the index of the slot in vnetconfig->publicips[] or 0 if the IP is not in the pool
+//!
+static int vnetFindPublicIP(vnetConfig * vnetconfig, u32 ip)
+{
+    int i = 0;
+
+    if (ip == 0)
+        return (0);
+
+    for (i = vnetconfig->publicipHash[vnetPublicIPBucket(ip)]; i > 0; i = vnetconfig->publicips[i].hashNext) {
+        if (vnetconfig->publicips[i].ip == ip)
+            return (i);
+    }
+    return (0);
+}
+
+//!
+//! Puts a public IP, known not to be in the pool yet, in the lowest free slot of the pool
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] ip the public IP to add
+//!
+//! @return the index of the slot in vnetconfig->publicips[] or 0 if the pool is full
+//!
+static int vnetInsertPublicIP(vnetConfig * vnetconfig, u32 ip)
+{
+    int i = 0;
+    u32 bucket = vnetPublicIPBucket(ip);
+
+    // slot 0 is never handed out, see vnetGetPublicIP()
+    if ((i = vnetFindBit(vnetconfig->publicipMap, 1, (NUMBER_OF_PUBLIC_IPS - 1), FALSE)) < 0)
+        return (0);
+
+    vnetconfig->publicipMap[i / 32] |= (1U << (i % 32));
+    vnetconfig->publicips[i].ip = ip;
+    vnetconfig->publicips[i].hashNext = vnetconfig->publicipHash[bucket];
+    vnetconfig->publicipHash[bucket] = i;
+    vnetTouchPublicIP(vnetconfig, i);
+    return (i);
+}
+
+//!
+//! Takes the public IP of a slot out of the pool. As before the index existed, the rest of
+//! the slot is left as is until the slot gets reused.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] idx the index of the slot in vnetconfig->publicips[]
+//!
+static void vnetRemovePublicIP(vnetConfig * vnetconfig, int idx)
+{
+    int *link = &(vnetconfig->publicipHash[vnetPublicIPBucket(vnetconfig->publicips[idx].ip)]);
+
+    while ((*link > 0) && (*link != idx))
+        link = &(vnetconfig->publicips[*link].hashNext);
+    if (*link == idx)
+        *link = vnetconfig->publicips[idx].hashNext;
+
+    vnetconfig->publicipMap[idx / 32] &= ~(1U << (idx % 32));
+    vnetconfig->publicips[idx].ip = 0;
+    vnetconfig->publicips[idx].hashNext = 0;
+    vnetTouchPublicIP(vnetconfig, idx);
+}
+
+//!
+//! Records a change to a slot of the public IP pool for vnetDescribePublicIPs()
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] idx the index of the slot in vnetconfig->publicips[]
+//!
+static void vnetTouchPublicIP(vnetConfig * vnetconfig, int idx)
+{
+    // the cursor 0 stands for "everything", never hand it out as a change
+    if (++vnetconfig->publicipSeq == 0)
+        vnetconfig->publicipSeq = 1;
+    vnetconfig->publicips[idx].changeSeq = vnetconfig->publicipSeq;
+}
+
 //!
 //!
 //!
@@ -3025,7 +3792,6 @@ int vnetStartNetwork(vnetConfig * vnetconfig, int vlan, char *uuid, char *userNa
 int vnetGetPublicIP(vnetConfig * vnetconfig, char *ip, char **dstip, int *allocated, int *addrdevno)
 {
     int i = 0;
-    boolean done = FALSE;
 
     // @todo CHUCK vnetGetPublicIP not found in param_check???
     if (param_check("vnetGetPublicIP", vnetconfig, ip, allocated, addrdevno)) {
@@ -3039,21 +3805,16 @@ int vnetGetPublicIP(vnetConfig * vnetconfig, char *ip, char **dstip, int *alloca
     }
 
     *allocated = *addrdevno = 0;
-    for (i = 1, done = FALSE; ((i < NUMBER_OF_PUBLIC_IPS) && !done); i++) {
-        if (vnetconfig->publicips[i].ip == dot2hex(ip)) {
-            if (dstip != NULL) {
-                *dstip = hex2dot(vnetconfig->publicips[i].dstip);
-            }
-            *allocated = vnetconfig->publicips[i].allocated;
-            *addrdevno = i;
-            done = TRUE;
-        }
-    }
-
-    if (!done) {
+    if ((i = vnetFindPublicIP(vnetconfig, dot2hex(ip))) == 0) {
         LOGERROR("could not find ip %s in list of allocateable publicips\n", ip);
         return (EUCA_NOT_FOUND_ERROR);
     }
+
+    if (dstip != NULL) {
+        *dstip = hex2dot(vnetconfig->publicips[i].dstip);
+    }
+    *allocated = vnetconfig->publicips[i].allocated;
+    *addrdevno = i;
     return (EUCA_OK);
 }
 
@@ -3071,22 +3832,15 @@ int vnetGetPublicIP(vnetConfig * vnetconfig, char *ip, char **dstip, int *alloca
 //!
 int vnetCheckPublicIP(vnetConfig * vnetconfig, char *ip)
 {
-    int i = 0;
-    u32 theip = 0;
-
     if (!vnetconfig || !ip) {
         LOGERROR("bad input params: vnetconfig=%p, ip=%s\n", vnetconfig, SP(ip));
         return (EUCA_INVALID_ERROR);
     }
 
-    theip = dot2hex(ip);
-
-    for (i = 0; i < NUMBER_OF_PUBLIC_IPS; i++) {
-        if (vnetconfig->publicips[i].ip == theip) {
-            return (EUCA_OK);
-        }
+    if (vnetFindPublicIP(vnetconfig, dot2hex(ip)) == 0) {
+        return (EUCA_NOT_FOUND_ERROR);
     }
-    return (EUCA_NOT_FOUND_ERROR);
+    return (EUCA_OK);
 }
 
 //!
@@ -3107,12 +3861,10 @@ int vnetAddPublicIP(vnetConfig * vnetconfig, char *inip)
     int j = 0;
     int slashnet = 0;
     int numips = 0;
-    int found = 0;
     u32 minip = 0;
     u32 theip = 0;
     char *ip = NULL;
     char *ptr = NULL;
-    boolean done = FALSE;
 
     if (param_check("vnetAddPublicIP", vnetconfig, inip)) {
         LOGERROR("bad input params: vnetconfig=%p, inip=%s\n", vnetconfig, SP(inip));
@@ -3123,12 +3875,8 @@ int vnetAddPublicIP(vnetConfig * vnetconfig, char *inip)
         // remove mode
         ip = inip + 1;
 
-        theip = dot2hex(ip);
-        for (i = 1, done = FALSE; ((i < NUMBER_OF_PUBLIC_IPS) && !done); i++) {
-            if (vnetconfig->publicips[i].ip == theip) {
-                vnetconfig->publicips[i].ip = 0;
-                done = TRUE;
-            }
+        if ((i = vnetFindPublicIP(vnetconfig, dot2hex(ip))) != 0) {
+            vnetRemovePublicIP(vnetconfig, i);
         }
     } else {
         // add mode
@@ -3159,20 +3907,9 @@ int vnetAddPublicIP(vnetConfig * vnetconfig, char *inip)
 
         for (j = 0; j < numips; j++) {
             theip = minip + j;
-            for (i = 1, done = FALSE, found = 0; ((i < NUMBER_OF_PUBLIC_IPS) && !done); i++) {
-                if (!vnetconfig->publicips[i].ip) {
-                    if (!found)
-                        found = i;
-                } else if (vnetconfig->publicips[i].ip == theip) {
-                    done = TRUE;
-                }
-            }
-
-            if (done) {
+            if (vnetFindPublicIP(vnetconfig, theip) != 0) {
                 //already there
-            } else if (found) {
-                vnetconfig->publicips[found].ip = theip;
-            } else {
+            } else if (vnetInsertPublicIP(vnetconfig, theip) == 0) {
                 LOGERROR("cannot add any more public IPS (limit:%d)\n", NUMBER_OF_PUBLIC_IPS);
                 return (EUCA_NO_SPACE_ERROR);
             }
@@ -3240,139 +3977,1189 @@ int vnetAddPrivateIP(vnetConfig * vnetconfig, char *inip)
             numips = 1;
         }
 
-        for (j = 0; j < numips; j++) {
-            theip = minip + j;
-            for (i = 1, done = FALSE, found = 0; ((i < NUMBER_OF_PRIVATE_IPS) && !done); i++) {
-                if (!vnetconfig->privateips[i].ip) {
-                    if (!found)
-                        found = i;
-                } else if (vnetconfig->privateips[i].ip == theip) {
-                    done = TRUE;
-                }
-            }
+        for (j = 0; j < numips; j++) {
+            theip = minip + j;
+            for (i = 1, done = FALSE, found = 0; ((i < NUMBER_OF_PRIVATE_IPS) && !done); i++) {
+                if (!vnetconfig->privateips[i].ip) {
+                    if (!found)
+                        found = i;
+                } else if (vnetconfig->privateips[i].ip == theip) {
+                    done = TRUE;
+                }
+            }
+
+            if (done) {
+                //already there
+            } else if (found) {
+                if (!strcmp(vnetconfig->mode, NETMODE_EDGE)) {
+                    theipstr = hex2dot(theip);
+                    if (theipstr)
+                        themacstr = ipdot2macdot(theipstr, vnetconfig->macPrefix);
+
+                    if (theipstr && themacstr) {
+                        vnetRefreshHost(vnetconfig, themacstr, theipstr, 0, -1);
+                    }
+                    EUCA_FREE(themacstr);
+                    EUCA_FREE(theipstr);
+                } else {
+                    vnetconfig->privateips[found].ip = theip;
+                }
+            } else {
+                LOGERROR("cannot add any more privatec IPS (limit:%d)\n", NUMBER_OF_PRIVATE_IPS);
+                return (EUCA_NO_SPACE_ERROR);
+            }
+        }
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//!
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] src
+//! @param[in] dst
+//! @param[in] vlan the VLAN identifier under which the dst address reside
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_ERROR: if we fail to assign the address
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!
+//! @pre \p vnetconfig, \p src and \p dst must not be NULL.
+//!
+//! @note Between vnetAssignBatchBegin() and vnetAssignBatchCommit(), the address and the rules are
+//!       only recorded, and the errors of applying them come out of vnetAssignBatchCommit().
+//!
+int vnetAssignAddress(vnetConfig * vnetconfig, char *src, char *dst, int vlan)
+{
+    int rc = 0;
+    int slashnet = 0;
+    int ret = EUCA_OK;
+    char cmd[EUCA_MAX_PATH] = "";
+    char *network = NULL;
+
+    if ((vnetconfig == NULL) || (src == NULL) || (dst == NULL)) {
+        LOGERROR("bad input params: vnetconfig=%p, src=%s, dst=%s\n", vnetconfig, SP(src), SP(dst));
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (((vnetconfig->role == CC) || (vnetconfig->role == CLC)) && (!strcmp(vnetconfig->mode, NETMODE_MANAGED) || !strcmp(vnetconfig->mode, NETMODE_MANAGED_NOVLAN))) {
+        if ((rc = vnetAssignIP(vnetconfig, src)) != EUCA_OK) {
+            LOGERROR("failed to assign IP address '%s'\n", src);
+            ret = EUCA_ERROR;
+        }
+
+        network = hex2dot(vnetconfig->nw);
+        slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->nm)) + 1);
+        snprintf(cmd, EUCA_MAX_PATH, "-A PREROUTING -s %s/%d -d %s -j MARK --set-xmark 0x15/0xffffffff", network, slashnet, src);
+        EUCA_FREE(network);
+        if ((rc = vnetAssignRule(vnetconfig, "nat", cmd)) != 0) {
+            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+
+        snprintf(cmd, EUCA_MAX_PATH, "-A PREROUTING -d %s -j DNAT --to-destination %s", src, dst);
+        if ((rc = vnetAssignRule(vnetconfig, "nat", cmd)) != 0) {
+            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+
+        network = hex2dot(vnetconfig->nw);
+        slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->nm)) + 1);
+        snprintf(cmd, EUCA_MAX_PATH, "-A OUTPUT -s %s/%d -d %s -j MARK --set-xmark 0x15/0xffffffff", network, slashnet, src);
+        EUCA_FREE(network);
+        if ((rc = vnetAssignRule(vnetconfig, "nat", cmd)) != 0) {
+            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+
+        snprintf(cmd, EUCA_MAX_PATH, "-A OUTPUT -d %s -j DNAT --to-destination %s", src, dst);
+        if ((rc = vnetAssignRule(vnetconfig, "nat", cmd)) != 0) {
+            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+
+        slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->networks[vlan].nm)) + 1);
+        network = hex2dot(vnetconfig->networks[vlan].nw);
+        snprintf(cmd, EUCA_MAX_PATH, "-I POSTROUTING -s %s ! -d %s/%d -j SNAT --to-source %s", dst, network, slashnet, src);
+        EUCA_FREE(network);
+        if ((rc = vnetAssignRule(vnetconfig, "nat", cmd)) != 0) {
+            LOGERROR("failed to apply SNAT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+        
+        //snprintf(cmd, EUCA_MAX_PATH, "-I POSTROUTING -s %s -d %s -j SNAT --to-source %s", dst, dst, src);
+        snprintf(cmd, EUCA_MAX_PATH, "-I POSTROUTING -s %s -m mark --mark 0x15 -j SNAT --to-source %s", dst, src);
+        if ((rc = vnetAssignRule(vnetconfig, "nat", cmd)) != 0) {
+            LOGERROR("failed to apply SNAT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+        // For reporting traffic statistics.
+        snprintf(cmd, EUCA_MAX_PATH, "-A EUCA_COUNTERS_IN -d %s", dst);
+        if ((rc = vnetAssignRule(vnetconfig, "filter", cmd)) != 0) {
+            LOGERROR("vnetAssignAddress(): failed to apply EUCA_COUNTERS_IN rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+
+        snprintf(cmd, EUCA_MAX_PATH, "-A EUCA_COUNTERS_OUT -s %s", dst);
+        if ((rc = vnetAssignRule(vnetconfig, "filter", cmd)) != 0) {
+            LOGERROR("vnetAssignAddress(): failed to apply EUCA_COUNTERS_OUT rule '%s'\n", cmd);
+            ret = EUCA_ERROR;
+        }
+    }
+    return (ret);
+}
+
+//!
+//! Opens an assignment batch: until vnetAssignBatchCommit(), the addresses and rules of the
+//! calls that this thread makes to vnetAssignAddress() are put off, so that reassigning
+//! all the public IPs after a restart takes one address update and one rule update per
+//! table rather than a few processes for every address
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if vnetconfig is NULL
+//!         \li EUCA_ERROR: if a batch is open already
+//!
+//! @pre The caller holds the VNET lock until it commits the batch.
+//!
+int vnetAssignBatchBegin(vnetConfig * vnetconfig)
+{
+    if (vnetconfig == NULL) {
+        LOGERROR("bad input params: vnetconfig=%p\n", vnetconfig);
+        return (EUCA_INVALID_ERROR);
+    }
+    if (assignBatch.active) {
+        LOGERROR("an assignment batch is open already\n");
+        return (EUCA_ERROR);
+    }
+
+    assignBatch.active = TRUE;
+    assignBatch.owner = pthread_self();
+    return (EUCA_OK);
+}
+
+//!
+//! Applies and closes the assignment batch opened by vnetAssignBatchBegin(). The addresses go
+//! onto the public interface in one netlink request, or one 'ip -batch' if this process may
+//! not change them, and the rules of each table go through one euca_ipt run.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if vnetconfig is NULL or no batch is open
+//!         \li EUCA_ERROR: if applying the addresses or the rules failed
+//!
+int vnetAssignBatchCommit(vnetConfig * vnetconfig)
+{
+    int fd = -1;
+    int rc = 0;
+    int ret = EUCA_OK;
+    char *ip = NULL;
+    char file[EUCA_MAX_PATH] = "/tmp/euca-ipaddr-XXXXXX";
+    char rootwrap[EUCA_MAX_PATH] = "";
+    const char *tables[ASSIGN_BATCH_TABLES] = { "nat", "filter" };
+    FILE *FH = NULL;
+
+    if ((vnetconfig == NULL) || !assignBatch.active) {
+        LOGERROR("bad input params: vnetconfig=%p, open batch=%d\n", vnetconfig, assignBatch.active);
+        return (EUCA_INVALID_ERROR);
+    }
+    assignBatch.active = FALSE;
+
+    if (assignBatch.numIps > 0) {
+        LOGDEBUG("adding %d addresses to %s\n", assignBatch.numIps, vnetconfig->pubInterface);
+        if ((rc = vnetNetlinkAddAddrs(vnetconfig->pubInterface, assignBatch.ips, assignBatch.numIps)) == EUCA_PERMISSION_ERROR) {
+            // not root, so the addresses go through rootwrap, all with one 'ip'
+            if (((fd = safe_mkstemp(file)) < 0) || ((FH = fdopen(fd, "w")) == NULL)) {
+                LOGERROR("cannot create temporary file for the address batch\n");
+                if (fd >= 0) {
+                    close(fd);
+                    unlink(file);
+                }
+                ret = EUCA_ERROR;
+            } else {
+                for (int i = 0; i < assignBatch.numIps; i++) {
+                    ip = hex2dot(assignBatch.ips[i]);
+                    fprintf(FH, "addr add %s/32 dev %s\n", ip, vnetconfig->pubInterface);
+                    EUCA_FREE(ip);
+                }
+                fclose(FH);
+                chmod(file, 0644);
+                snprintf(rootwrap, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, vnetconfig->eucahome);
+                // -force carries on past addresses that are there already, which also makes ip exit non-zero
+                if (euca_execlp(NULL, rootwrap, "ip", "-force", "-batch", file, NULL) != EUCA_OK)
+                    LOGWARN("some of the %d addresses were not added to %s, or were there already\n", assignBatch.numIps, vnetconfig->pubInterface);
+                unlink(file);
+            }
+        } else if (rc != EUCA_OK) {
+            LOGERROR("failed to add %d addresses to %s\n", assignBatch.numIps, vnetconfig->pubInterface);
+            ret = EUCA_ERROR;
+        }
+    }
+
+    for (int i = 0; i < ASSIGN_BATCH_TABLES; i++) {
+        if (assignBatch.len[i] == 0)
+            continue;
+        // euca_ipt skips the rules that are in the table already, one per line
+        if (vnetApplySingleTableRule(vnetconfig, (char *)tables[i], assignBatch.rules[i]) != EUCA_OK) {
+            LOGERROR("failed to apply the batch of %s rules\n", tables[i]);
+            ret = EUCA_ERROR;
+        }
+    }
+
+    // the flows of the addresses that moved only pick up the new rules once their entries are gone
+    if (assignBatch.numMovedIps > 0) {
+        vnetConntrackDelete(vnetconfig->eucahome, assignBatch.movedIps, assignBatch.numMovedIps);
+    }
+
+    for (int i = 0; i < ASSIGN_BATCH_TABLES; i++) {
+        EUCA_FREE(assignBatch.rules[i]);
+        assignBatch.len[i] = assignBatch.size[i] = 0;
+    }
+    EUCA_FREE(assignBatch.ips);
+    assignBatch.numIps = assignBatch.maxIps = 0;
+    EUCA_FREE(assignBatch.movedIps);
+    assignBatch.numMovedIps = assignBatch.maxMovedIps = 0;
+    return (ret);
+}
+
+//!
+//! Tells whether the assignments of the calling thread go into an assignment batch
+//!
+//! @return TRUE if this thread opened the batch that is open
+//!
+static boolean vnetAssignBatching(void)
+{
+    return ((assignBatch.active && pthread_equal(assignBatch.owner, pthread_self())) ? TRUE : FALSE);
+}
+
+//!
+//! Applies one of the rules of vnetAssignAddress(), or adds it to the assignment batch
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] table nat or filter
+//! @param[in] rule
+//!
+//! @return EUCA_OK on success, EUCA_MEMORY_ERROR if the batch cannot grow, or the result of vnetApplySingleTableRule()
+//!
+static int vnetAssignRule(vnetConfig * vnetconfig, char *table, char *rule)
+{
+    int i = (!strcmp(table, "nat")) ? (ASSIGN_BATCH_NAT) : (ASSIGN_BATCH_FILTER);
+    size_t len = strlen(rule);
+    char *grown = NULL;
+
+    if (!vnetAssignBatching())
+        return (vnetApplySingleTableRule(vnetconfig, table, rule));
+
+    if ((assignBatch.len[i] + len + 2) > assignBatch.size[i]) {
+        if ((grown = EUCA_REALLOC(assignBatch.rules[i], (assignBatch.size[i] + len + 2) * 2, sizeof(char))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        assignBatch.rules[i] = grown;
+        assignBatch.size[i] = (assignBatch.size[i] + len + 2) * 2;
+    }
+    if (assignBatch.len[i] > 0)
+        assignBatch.rules[i][assignBatch.len[i]++] = '\n';
+    memcpy(assignBatch.rules[i] + assignBatch.len[i], rule, len + 1);
+    assignBatch.len[i] += len;
+    return (EUCA_OK);
+}
+
+//!
+//! Adds a public IP to the public interface, or to the assignment batch
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] src the public IP
+//!
+//! @return EUCA_OK on success, EUCA_MEMORY_ERROR if the batch cannot grow, or EUCA_ERROR if the address was not added
+//!
+static int vnetAssignIP(vnetConfig * vnetconfig, char *src)
+{
+    u32 *grown = NULL;
+
+    if (!vnetAssignBatching())
+        return (vnetAddrChange(vnetconfig, TRUE, vnetconfig->pubInterface, dot2hex(src), 32, 0));
+
+    if (assignBatch.numIps == assignBatch.maxIps) {
+        if ((grown = EUCA_REALLOC(assignBatch.ips, (assignBatch.maxIps + 64), sizeof(u32))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        assignBatch.ips = grown;
+        assignBatch.maxIps += 64;
+    }
+    assignBatch.ips[assignBatch.numIps++] = dot2hex(src);
+    return (EUCA_OK);
+}
+
+//!
+//! Adds /32 addresses to a device with RTM_NEWADDR requests, many to a netlink message
+//!
+//! @param[in] dev the device
+//! @param[in] ips the addresses
+//! @param[in] numIps number of addresses
+//!
+//! @return EUCA_OK if every address is on the device now, EUCA_PERMISSION_ERROR if this process
+//!         may not change addresses, EUCA_NOT_FOUND_ERROR if there is no such device or EUCA_ERROR
+//!
+static int vnetNetlinkAddAddrs(const char *dev, const u32 * ips, int numIps)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    int acks = 0;
+    int count = 0;
+    int ifindex = 0;
+    u32 addr = 0;
+    ssize_t got = 0;
+    size_t msglen = NLMSG_SPACE(sizeof(struct ifaddrmsg)) + 2 * RTA_SPACE(sizeof(u32));
+    char *buf = NULL;
+    char reply[8192] = "";
+    struct nlmsghdr *nh = NULL;
+    struct nlmsgerr *err = NULL;
+    struct ifaddrmsg *ifa = NULL;
+    struct rtattr *rta = NULL;
+    struct sockaddr_nl sa = { 0 };
+
+    if ((ifindex = if_nametoindex(dev)) == 0)
+        return (EUCA_NOT_FOUND_ERROR);
+    if ((buf = EUCA_ALLOC(NETLINK_BATCH_ADDRS, msglen)) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+        EUCA_FREE(buf);
+        return (EUCA_ERROR);
+    }
+    sa.nl_family = AF_NETLINK;
+
+    for (int first = 0; (first < numIps) && (ret == EUCA_OK); first += count) {
+        count = ((numIps - first) < NETLINK_BATCH_ADDRS) ? (numIps - first) : (NETLINK_BATCH_ADDRS);
+        memset(buf, 0, count * msglen);
+        for (int i = 0; i < count; i++) {
+            nh = (struct nlmsghdr *)(buf + i * msglen);
+            nh->nlmsg_len = msglen;
+            nh->nlmsg_type = RTM_NEWADDR;
+            nh->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
+            nh->nlmsg_seq = first + i + 1;
+            ifa = NLMSG_DATA(nh);
+            ifa->ifa_family = AF_INET;
+            ifa->ifa_prefixlen = 32;
+            ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+            ifa->ifa_index = ifindex;
+            addr = htonl(ips[first + i]);
+            rta = (struct rtattr *)((char *)ifa + NLMSG_ALIGN(sizeof(struct ifaddrmsg)));
+            rta->rta_type = IFA_LOCAL;
+            rta->rta_len = RTA_LENGTH(sizeof(u32));
+            memcpy(RTA_DATA(rta), &addr, sizeof(u32));
+            rta = (struct rtattr *)((char *)rta + RTA_SPACE(sizeof(u32)));
+            rta->rta_type = IFA_ADDRESS;
+            rta->rta_len = RTA_LENGTH(sizeof(u32));
+            memcpy(RTA_DATA(rta), &addr, sizeof(u32));
+        }
+        if (sendto(fd, buf, count * msglen, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+            ret = (errno == EPERM) ? (EUCA_PERMISSION_ERROR) : (EUCA_ERROR);
+            break;
+        }
+
+        // every request is acknowledged, with its error if it failed
+        for (acks = 0; (acks < count) && (ret == EUCA_OK);) {
+            if ((got = recv(fd, reply, sizeof(reply), 0)) < 0) {
+                ret = EUCA_ERROR;
+                break;
+            }
+            for (nh = (struct nlmsghdr *)reply; NLMSG_OK(nh, got); nh = NLMSG_NEXT(nh, got)) {
+                if (nh->nlmsg_type != NLMSG_ERROR)
+                    continue;
+                acks++;
+                err = NLMSG_DATA(nh);
+                if ((err->error == 0) || (err->error == -EEXIST))
+                    continue;
+                if ((err->error == -EPERM) && (ret == EUCA_OK))
+                    ret = EUCA_PERMISSION_ERROR;
+                else if (ret == EUCA_OK)
+                    ret = EUCA_ERROR;
+                if (ret == EUCA_ERROR)
+                    LOGERROR("kernel refused address %d of the batch for %s: %s\n", nh->nlmsg_seq, dev, strerror(-err->error));
+            }
+        }
+    }
+
+    close(fd);
+    EUCA_FREE(buf);
+    return (ret);
+}
+
+//!
+//! Deletes the connection tracking entries of addresses whose NAT rules just changed, so that
+//! the flows they carry pick up the new rules rather than keep the translation they started
+//! with. Only the entries of flows to one of the addresses, or from it or answered to it
+//! after a SNAT, are deleted; the other flows of the host are left alone. The table is
+//! searched over ctnetlink. A process that may not use ctnetlink goes through rootwrap and
+//! the conntrack tool instead, with one filter per address and direction.
+//!
+//! @param[in] eucahome the eucalyptus home directory, for rootwrap
+//! @param[in] ips the addresses
+//! @param[in] numIps number of addresses
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if any parameter does not meet the preconditions,
+//!         or EUCA_ERROR if the entries could not be looked up
+//!
+//! @pre \p eucahome and \p ips must not be NULL.
+//!
+int vnetConntrackDelete(const char *eucahome, const u32 * ips, int numIps)
+{
+    int rc = 0;
+    int deleted = 0;
+    char *ip = NULL;
+    char rootwrap[EUCA_MAX_PATH] = "";
+    const char *filters[] = { "-d", "-s", "-q" };   // original destination, original source, reply destination
+
+    if ((eucahome == NULL) || (ips == NULL)) {
+        LOGERROR("bad input params: eucahome=%s, ips=%p\n", SP(eucahome), ips);
+        return (EUCA_INVALID_ERROR);
+    }
+    if (numIps <= 0)
+        return (EUCA_OK);
+
+    if ((rc = vnetNetlinkConntrackDelete(ips, numIps, &deleted)) == EUCA_OK) {
+        LOGDEBUG("deleted %d conntrack entries of %d moved address(es)\n", deleted, numIps);
+        return (EUCA_OK);
+    } else if (rc != EUCA_PERMISSION_ERROR) {
+        LOGWARN("cannot delete the conntrack entries of %d moved address(es)\n", numIps);
+        return (EUCA_ERROR);
+    }
+
+    // conntrack exits non-zero when no entry matched, which is fine
+    snprintf(rootwrap, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, eucahome);
+    for (int i = 0; i < numIps; i++) {
+        if ((ip = hex2dot(ips[i])) == NULL)
+            continue;
+        for (int j = 0; j < (sizeof(filters) / sizeof(filters[0])); j++) {
+            euca_execlp(NULL, rootwrap, "conntrack", "-D", "-f", "ipv4", filters[j], ip, NULL);
+        }
+        LOGDEBUG("deleted the conntrack entries of %s\n", ip);
+        EUCA_FREE(ip);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Gets the addresses of a conntrack tuple
+//!
+//! @param[in]  tuple the CTA_TUPLE_ORIG or CTA_TUPLE_REPLY attribute of a conntrack entry
+//! @param[out] src the source address, host byte order
+//! @param[out] dst the destination address, host byte order
+//!
+//! @return TRUE if the tuple is an IPv4 one with both addresses
+//!
+static boolean vnetConntrackTupleIps(struct nlattr *tuple, u32 * src, u32 * dst)
+{
+    int len = 0;
+    int iplen = 0;
+    int found = 0;
+    u32 addr = 0;
+    struct nlattr *attr = NULL;
+    struct nlattr *ipattr = NULL;
+
+    len = tuple->nla_len - NLA_HDRLEN;
+    for (attr = (struct nlattr *)((char *)tuple + NLA_HDRLEN); (len >= NLA_HDRLEN) && (attr->nla_len >= NLA_HDRLEN) && (attr->nla_len <= len);
+         len -= NLA_ALIGN(attr->nla_len), attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len))) {
+        if ((attr->nla_type & NLA_TYPE_MASK) != CTA_TUPLE_IP)
+            continue;
+
+        iplen = attr->nla_len - NLA_HDRLEN;
+        for (ipattr = (struct nlattr *)((char *)attr + NLA_HDRLEN); (iplen >= NLA_HDRLEN) && (ipattr->nla_len >= NLA_HDRLEN) && (ipattr->nla_len <= iplen);
+             iplen -= NLA_ALIGN(ipattr->nla_len), ipattr = (struct nlattr *)((char *)ipattr + NLA_ALIGN(ipattr->nla_len))) {
+            if (ipattr->nla_len != (NLA_HDRLEN + sizeof(u32)))
+                continue;
+            memcpy(&addr, ((char *)ipattr + NLA_HDRLEN), sizeof(u32));
+            if ((ipattr->nla_type & NLA_TYPE_MASK) == CTA_IP_V4_SRC) {
+                *src = ntohl(addr);
+                found |= 1;
+            } else if ((ipattr->nla_type & NLA_TYPE_MASK) == CTA_IP_V4_DST) {
+                *dst = ntohl(addr);
+                found |= 2;
+            }
+        }
+    }
+    return ((found == 3) ? TRUE : FALSE);
+}
+
+//!
+//! Does what vnetConntrackDelete() does, over ctnetlink: the IPv4 conntrack table is dumped,
+//! and the entries matching one of the addresses are then deleted by their original tuple
+//!
+//! @param[in]  ips the addresses
+//! @param[in]  numIps number of addresses
+//! @param[out] deleted number of entries deleted
+//!
+//! @return EUCA_OK on success, EUCA_PERMISSION_ERROR if this process may not use ctnetlink,
+//!         EUCA_MEMORY_ERROR or EUCA_ERROR
+//!
+static int vnetNetlinkConntrackDelete(const u32 * ips, int numIps, int *deleted)
+{
+    int fd = -1;
+    int len = 0;
+    int ret = EUCA_OK;
+    int done = 0;
+    int matched = 0;
+    u32 osrc = 0, odst = 0, rsrc = 0, rdst = 0;
+    ssize_t got = 0;
+    size_t used = 0;
+    size_t size = 0;
+    char *buf = NULL;
+    char *grown = NULL;
+    char *victims = NULL;              // the CTA_TUPLE_ORIG attributes of the entries to delete, back to back
+    char reply[8192] = "";
+    struct nlmsghdr *nh = NULL;
+    struct nlmsgerr *err = NULL;
+    struct nfgenmsg *nfg = NULL;
+    struct nlattr *attr = NULL;
+    struct nlattr *orig = NULL;
+    struct nlattr *repl = NULL;
+    struct sockaddr_nl sa = { 0 };
+    struct {
+        struct nlmsghdr nh;
+        struct nfgenmsg nfg;
+        char tuple[256];
+    } req;
+
+    *deleted = 0;
+    if (!netlinkAllowed)
+        return (EUCA_PERMISSION_ERROR);
+    if ((buf = EUCA_ALLOC(CONNTRACK_DUMP_BUFSIZE, sizeof(char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER)) < 0) {
+        EUCA_FREE(buf);
+        return ((errno == EPERM) ? (EUCA_PERMISSION_ERROR) : (EUCA_ERROR));
+    }
+    sa.nl_family = AF_NETLINK;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    req.nh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_GET;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = 1;
+    req.nfg.nfgen_family = AF_INET;
+    req.nfg.version = NFNETLINK_V0;
+    if (sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        ret = (errno == EPERM) ? (EUCA_PERMISSION_ERROR) : (EUCA_ERROR);
+        done = 1;
+    }
+
+    // entries cannot go while the dump walks the table, so the ones to delete are set aside first
+    while (!done && (ret == EUCA_OK)) {
+        if ((got = recv(fd, buf, CONNTRACK_DUMP_BUFSIZE, 0)) <= 0) {
+            ret = EUCA_ERROR;
+            break;
+        }
+        for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, got); nh = NLMSG_NEXT(nh, got)) {
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                done = 1;
+                break;
+            } else if (nh->nlmsg_type == NLMSG_ERROR) {
+                err = NLMSG_DATA(nh);
+                ret = (err->error == -EPERM) ? (EUCA_PERMISSION_ERROR) : (EUCA_ERROR);
+                break;
+            }
+
+            nfg = NLMSG_DATA(nh);
+            orig = repl = NULL;
+            len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg));
+            for (attr = (struct nlattr *)((char *)nfg + NLMSG_ALIGN(sizeof(struct nfgenmsg))); (len >= NLA_HDRLEN) && (attr->nla_len >= NLA_HDRLEN) && (attr->nla_len <= len);
+                 len -= NLA_ALIGN(attr->nla_len), attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len))) {
+                if ((attr->nla_type & NLA_TYPE_MASK) == CTA_TUPLE_ORIG)
+                    orig = attr;
+                else if ((attr->nla_type & NLA_TYPE_MASK) == CTA_TUPLE_REPLY)
+                    repl = attr;
+            }
+            if (!orig || !repl || (orig->nla_len > sizeof(req.tuple)) || !vnetConntrackTupleIps(orig, &osrc, &odst) || !vnetConntrackTupleIps(repl, &rsrc, &rdst))
+                continue;
+
+            matched = 0;
+            for (int i = 0; (i < numIps) && !matched; i++) {
+                matched = ((odst == ips[i]) || (osrc == ips[i]) || (rdst == ips[i]));
+            }
+            if (!matched)
+                continue;
+
+            if ((used + NLA_ALIGN(orig->nla_len)) > size) {
+                if ((grown = EUCA_REALLOC(victims, (size + 4096), sizeof(char))) == NULL) {
+                    ret = EUCA_MEMORY_ERROR;
+                    break;
+                }
+                victims = grown;
+                size += 4096;
+            }
+            memcpy(victims + used, orig, orig->nla_len);
+            used += NLA_ALIGN(orig->nla_len);
+        }
+    }
+
+    for (size_t off = 0; (ret == EUCA_OK) && (off < used); off += NLA_ALIGN(orig->nla_len)) {
+        orig = (struct nlattr *)(victims + off);
+
+        memset(&req, 0, sizeof(req));
+        memcpy(req.tuple, orig, orig->nla_len);
+        req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg)) + NLA_ALIGN(orig->nla_len);
+        req.nh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8) | IPCTNL_MSG_CT_DELETE;
+        req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+        req.nh.nlmsg_seq = 2;
+        req.nfg.nfgen_family = AF_INET;
+        req.nfg.version = NFNETLINK_V0;
+        if (sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+            ret = (errno == EPERM) ? (EUCA_PERMISSION_ERROR) : (EUCA_ERROR);
+            break;
+        }
+        if ((got = recv(fd, reply, sizeof(reply), 0)) <= 0) {
+            ret = EUCA_ERROR;
+            break;
+        }
+        for (nh = (struct nlmsghdr *)reply; NLMSG_OK(nh, got); nh = NLMSG_NEXT(nh, got)) {
+            if (nh->nlmsg_type != NLMSG_ERROR)
+                continue;
+            err = NLMSG_DATA(nh);
+            if (err->error == 0) {
+                (*deleted)++;
+            } else if (err->error == -EPERM) {
+                ret = EUCA_PERMISSION_ERROR;
+            } else if (err->error != -ENOENT) {
+                // an entry that timed out since the dump is gone already
+                LOGDEBUG("kernel refused to delete a conntrack entry: %s\n", strerror(-err->error));
+            }
+            break;
+        }
+    }
+
+    if (ret == EUCA_PERMISSION_ERROR) {
+        LOGDEBUG("no privileges for ctnetlink, using rootwrap for conntrack entries from now on\n");
+        netlinkAllowed = FALSE;
+    }
+
+    close(fd);
+    EUCA_FREE(victims);
+    EUCA_FREE(buf);
+    return (ret);
+}
+
+//!
+//! Sends one rtnetlink request and waits for its acknowledgement. Once the kernel has turned
+//! down a request for lack of privileges, later requests are not sent at all, so that a
+//! process that goes through rootwrap does not pay for them.
+//!
+//! @param[in] nh the request, NLM_F_REQUEST and NLM_F_ACK are added to its flags
+//!
+//! @return 0 on success or the negated errno of the failure
+//!
+static int vnetNetlinkTalk(struct nlmsghdr *nh)
+{
+    int fd = -1;
+    int ret = -EIO;
+    ssize_t got = 0;
+    char reply[8192] = "";
+    struct nlmsghdr *rh = NULL;
+    struct sockaddr_nl sa = { 0 };
+
+    if (!netlinkAllowed)
+        return (-EPERM);
+    if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+        return (-errno);
+
+    sa.nl_family = AF_NETLINK;
+    nh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    nh->nlmsg_seq = 1;
+    if (sendto(fd, nh, nh->nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        ret = -errno;
+    } else if ((got = recv(fd, reply, sizeof(reply), 0)) > 0) {
+        for (rh = (struct nlmsghdr *)reply; NLMSG_OK(rh, got); rh = NLMSG_NEXT(rh, got)) {
+            if (rh->nlmsg_type == NLMSG_ERROR) {
+                ret = ((struct nlmsgerr *)NLMSG_DATA(rh))->error;
+                break;
+            }
+        }
+    }
+    close(fd);
+
+    if (ret == -EPERM) {
+        LOGDEBUG("no privileges for netlink, using commands for links and addresses from now on\n");
+        netlinkAllowed = FALSE;
+    }
+    return (ret);
+}
+
+//!
+//! Appends an attribute to a netlink request
+//!
+//! @param[in] nh the request, with room for the attribute
+//! @param[in] type of the attribute
+//! @param[in] data of the attribute, or NULL to start a nested one
+//! @param[in] len bytes of data
+//!
+//! @return The attribute, which vnetNetlinkNestEnd() closes if it is nested
+//!
+static struct rtattr *vnetNetlinkAttr(struct nlmsghdr *nh, int type, const void *data, int len)
+{
+    struct rtattr *rta = (struct rtattr *)((char *)nh + NLMSG_ALIGN(nh->nlmsg_len));
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    if (data)
+        memcpy(RTA_DATA(rta), data, len);
+    nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+    return (rta);
+}
+
+//!
+//! Closes a nested attribute of a netlink request, once everything in it has been appended
+//!
+//! @param[in] nh the request
+//! @param[in] nest the attribute that vnetNetlinkAttr() started
+//!
+static void vnetNetlinkNestEnd(struct nlmsghdr *nh, struct rtattr *nest)
+{
+    nest->rta_len = ((char *)nh + nh->nlmsg_len) - (char *)nest;
+}
+
+//!
+//! Starts an RTM_NEWLINK or RTM_DELLINK request
+//!
+//! @param[out] req the request
+//! @param[in]  type RTM_NEWLINK or RTM_DELLINK
+//! @param[in]  flags NLM_F_CREATE and NLM_F_EXCL for new links
+//! @param[in]  ifindex of the link, or 0 for a new one
+//!
+//! @return The interface message of the request
+//!
+static struct ifinfomsg *vnetNetlinkLinkReq(vnetNetlinkReq * req, int type, int flags, int ifindex)
+{
+    memset(req, 0, sizeof(vnetNetlinkReq));
+    req->nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req->nh.nlmsg_type = type;
+    req->nh.nlmsg_flags = flags;
+    req->u.ifi.ifi_family = AF_UNSPEC;
+    req->u.ifi.ifi_index = ifindex;
+    return (&(req->u.ifi));
+}
+
+//!
+//! Runs a command through rootwrap
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] format of the command line after rootwrap, followed by its arguments
+//!
+//! @return The exit code of the command
+//!
+static int vnetRootwrap(vnetConfig * vnetconfig, const char *format, ...)
+{
+    int rc = 0;
+    char cmd[EUCA_MAX_PATH] = "";
+    char args[EUCA_MAX_PATH] = "";
+    va_list ap;
+
+    va_start(ap, format);
+    vsnprintf(args, sizeof(args), format, ap);
+    va_end(ap);
+
+    snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " %s", vnetconfig->eucahome, args);
+    LOGDEBUG("running cmd '%s'\n", cmd);
+    rc = system(cmd);
+    return (rc >> 8);
+}
+
+//!
+//! Creates the VLAN interface <dev>.<vlan>, like 'vconfig add' does
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] dev the underlying interface
+//! @param[in] vlan the VLAN tag
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetLinkAddVlan(vnetConfig * vnetconfig, const char *dev, int vlan)
+{
+    int ifindex = if_nametoindex(dev);
+    u16 id = vlan;
+    char name[IFNAMSIZ] = "";
+    struct rtattr *info = NULL;
+    struct rtattr *data = NULL;
+    vnetNetlinkReq req;
+
+    snprintf(name, sizeof(name), "%s.%d", dev, vlan);
+    if (ifindex > 0) {
+        vnetNetlinkLinkReq(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_LINK, &ifindex, sizeof(ifindex));
+        vnetNetlinkAttr(&req.nh, IFLA_IFNAME, name, strlen(name) + 1);
+        info = vnetNetlinkAttr(&req.nh, IFLA_LINKINFO, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_INFO_KIND, "vlan", strlen("vlan"));
+        data = vnetNetlinkAttr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_VLAN_ID, &id, sizeof(id));
+        vnetNetlinkNestEnd(&req.nh, data);
+        vnetNetlinkNestEnd(&req.nh, info);
+        if (vnetNetlinkTalk(&req.nh) == 0)
+            return (EUCA_OK);
+    }
+    return ((vnetRootwrap(vnetconfig, "vconfig add %s %d", dev, vlan) == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
+
+//!
+//! Removes a VLAN interface, like 'vconfig rem' does
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] dev the VLAN interface
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetLinkDelVlan(vnetConfig * vnetconfig, const char *dev)
+{
+    int ifindex = if_nametoindex(dev);
+    vnetNetlinkReq req;
+
+    if (ifindex > 0) {
+        vnetNetlinkLinkReq(&req, RTM_DELLINK, 0, ifindex);
+        if (vnetNetlinkTalk(&req.nh) == 0)
+            return (EUCA_OK);
+    }
+    return ((vnetRootwrap(vnetconfig, "vconfig rem %s", dev) == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
+
+//!
+//! Creates the kernel tunnel device to another CC, a point-to-point VXLAN or gretap device
+//! depending on the tunnel mode, like 'ip link add' does. Both CCs of a pair use the same
+//! VXLAN VNI, which tells the tunnel of the pair apart from the others at either end.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] dev the tunnel device
+//! @param[in] localId the index of the local CC in vnetconfig->tunnels.ccs[]
+//! @param[in] remoteId the index of the remote CC in vnetconfig->tunnels.ccs[]
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetLinkAddTunnel(vnetConfig * vnetconfig, const char *dev, int localId, int remoteId)
+{
+    int rc = 0;
+    u16 port = htons(TUNNEL_VXLAN_PORT);
+    u32 local = htonl(vnetconfig->tunnels.ccs[localId]);
+    u32 remote = htonl(vnetconfig->tunnels.ccs[remoteId]);
+    u32 vni = TUNNEL_VXLAN_VNI_BASE + (MIN(localId, remoteId) * NUMBER_OF_CCS) + MAX(localId, remoteId);
+    char *localIp = NULL;
+    char *remoteIp = NULL;
+    struct rtattr *info = NULL;
+    struct rtattr *data = NULL;
+    vnetNetlinkReq req;
+
+    vnetNetlinkLinkReq(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, 0);
+    vnetNetlinkAttr(&req.nh, IFLA_IFNAME, dev, strlen(dev) + 1);
+    info = vnetNetlinkAttr(&req.nh, IFLA_LINKINFO, NULL, 0);
+    if (vnetconfig->tunnels.mode == TUNNEL_VXLAN) {
+        vnetNetlinkAttr(&req.nh, IFLA_INFO_KIND, "vxlan", strlen("vxlan"));
+        data = vnetNetlinkAttr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_VXLAN_ID, &vni, sizeof(vni));
+        vnetNetlinkAttr(&req.nh, IFLA_VXLAN_GROUP, &remote, sizeof(remote));
+        vnetNetlinkAttr(&req.nh, IFLA_VXLAN_LOCAL, &local, sizeof(local));
+        vnetNetlinkAttr(&req.nh, IFLA_VXLAN_PORT, &port, sizeof(port));
+    } else {
+        vnetNetlinkAttr(&req.nh, IFLA_INFO_KIND, "gretap", strlen("gretap"));
+        data = vnetNetlinkAttr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_GRE_LOCAL, &local, sizeof(local));
+        vnetNetlinkAttr(&req.nh, IFLA_GRE_REMOTE, &remote, sizeof(remote));
+    }
+    vnetNetlinkNestEnd(&req.nh, data);
+    vnetNetlinkNestEnd(&req.nh, info);
+    if (vnetNetlinkTalk(&req.nh) == 0)
+        return (EUCA_OK);
+
+    localIp = hex2dot(vnetconfig->tunnels.ccs[localId]);
+    remoteIp = hex2dot(vnetconfig->tunnels.ccs[remoteId]);
+    if (vnetconfig->tunnels.mode == TUNNEL_VXLAN) {
+        rc = vnetRootwrap(vnetconfig, "ip link add %s type vxlan id %u remote %s local %s dstport %d", dev, vni, remoteIp, localIp, TUNNEL_VXLAN_PORT);
+    } else {
+        rc = vnetRootwrap(vnetconfig, "ip link add %s type gretap remote %s local %s", dev, remoteIp, localIp);
+    }
+    EUCA_FREE(localIp);
+    EUCA_FREE(remoteIp);
+    return ((rc == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
 
-            if (done) {
-                //already there
-            } else if (found) {
-                if (!strcmp(vnetconfig->mode, NETMODE_EDGE)) {
-                    theipstr = hex2dot(theip);
-                    if (theipstr)
-                        themacstr = ipdot2macdot(theipstr, vnetconfig->macPrefix);
+//!
+//! Removes a kernel tunnel device, like 'ip link del' does
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] dev the tunnel device
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetLinkDelTunnel(vnetConfig * vnetconfig, const char *dev)
+{
+    int ifindex = if_nametoindex(dev);
+    vnetNetlinkReq req;
 
-                    if (theipstr && themacstr) {
-                        vnetRefreshHost(vnetconfig, themacstr, theipstr, 0, -1);
-                    }
-                    EUCA_FREE(themacstr);
-                    EUCA_FREE(theipstr);
-                } else {
-                    vnetconfig->privateips[found].ip = theip;
-                }
-            } else {
-                LOGERROR("cannot add any more privatec IPS (limit:%d)\n", NUMBER_OF_PRIVATE_IPS);
-                return (EUCA_NO_SPACE_ERROR);
-            }
-        }
+    if (ifindex > 0) {
+        vnetNetlinkLinkReq(&req, RTM_DELLINK, 0, ifindex);
+        if (vnetNetlinkTalk(&req.nh) == 0)
+            return (EUCA_OK);
     }
+    return ((vnetRootwrap(vnetconfig, "ip link del %s", dev) == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
 
+//!
+//! Creates a bridge, like 'brctl addbr' does, optionally with STP off and the forward delay
+//! and hello time at 2 seconds, so that the ports of a new network forward right away
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] brname the bridge
+//! @param[in] quick set to TRUE for STP off and the short timers
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the bridge was not created
+//!
+static int vnetLinkAddBridge(vnetConfig * vnetconfig, const char *brname, boolean quick)
+{
+    struct rtattr *info = NULL;
+    vnetNetlinkReq req;
+#ifdef IFLA_BR_MAX
+    u32 off = 0;
+    u32 two_sec = 200;                 // in hundredths of a second
+    struct rtattr *data = NULL;
+#endif /* IFLA_BR_MAX */
+
+    vnetNetlinkLinkReq(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL, 0);
+    vnetNetlinkAttr(&req.nh, IFLA_IFNAME, brname, strlen(brname) + 1);
+    info = vnetNetlinkAttr(&req.nh, IFLA_LINKINFO, NULL, 0);
+    vnetNetlinkAttr(&req.nh, IFLA_INFO_KIND, "bridge", strlen("bridge"));
+#ifdef IFLA_BR_MAX
+    if (quick) {
+        data = vnetNetlinkAttr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_BR_STP_STATE, &off, sizeof(off));
+        vnetNetlinkAttr(&req.nh, IFLA_BR_FORWARD_DELAY, &two_sec, sizeof(two_sec));
+        vnetNetlinkAttr(&req.nh, IFLA_BR_HELLO_TIME, &two_sec, sizeof(two_sec));
+        vnetNetlinkNestEnd(&req.nh, data);
+        quick = FALSE;                 // all set already
+    }
+#endif /* IFLA_BR_MAX */
+    vnetNetlinkNestEnd(&req.nh, info);
+
+    if (vnetNetlinkTalk(&req.nh) != 0) {
+        if (vnetRootwrap(vnetconfig, "brctl addbr %s", brname) != 0)
+            return (EUCA_ERROR);
+        quick = TRUE;                  // via brctl as well
+    }
+    if (quick) {
+        if (vnetRootwrap(vnetconfig, "brctl stp %s off", brname) != 0)
+            LOGWARN("could not disable stp on bridge %s\n", brname);
+        if (vnetRootwrap(vnetconfig, "brctl setfd %s 2", brname) != 0)
+            LOGWARN("could not set fd time to 2 on bridge %s\n", brname);
+        if (vnetRootwrap(vnetconfig, "brctl sethello %s 2", brname) != 0)
+            LOGWARN("could not set hello time to 2 on bridge %s\n", brname);
+    }
     return (EUCA_OK);
 }
 
 //!
-//!
+//! Turns STP on or off on a bridge, like 'brctl stp' does
 //!
 //! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
-//! @param[in] src
-//! @param[in] dst
-//! @param[in] vlan the VLAN identifier under which the dst address reside
-//!
-//! @return EUCA_OK on success or the following error codes:
-//!         \li EUCA_ERROR: if we fail to assign the address
-//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//! @param[in] brname the bridge
+//! @param[in] on set to TRUE to turn STP on
 //!
-//! @pre \p vnetconfig, \p src and \p dst must not be NULL.
+//! @return EUCA_OK on success or EUCA_ERROR on failure
 //!
-int vnetAssignAddress(vnetConfig * vnetconfig, char *src, char *dst, int vlan)
+static int vnetBridgeSetStp(vnetConfig * vnetconfig, const char *brname, boolean on)
 {
-    int rc = 0;
-    int slashnet = 0;
-    int ret = EUCA_OK;
-    char cmd[EUCA_MAX_PATH] = "";
-    char *network = NULL;
-
-    if ((vnetconfig == NULL) || (src == NULL) || (dst == NULL)) {
-        LOGERROR("bad input params: vnetconfig=%p, src=%s, dst=%s\n", vnetconfig, SP(src), SP(dst));
-        return (EUCA_INVALID_ERROR);
+#ifdef IFLA_BR_MAX
+    int ifindex = if_nametoindex(brname);
+    u32 state = (on) ? (1) : (0);
+    struct rtattr *info = NULL;
+    struct rtattr *data = NULL;
+    vnetNetlinkReq req;
+
+    if (ifindex > 0) {
+        vnetNetlinkLinkReq(&req, RTM_NEWLINK, 0, ifindex);
+        info = vnetNetlinkAttr(&req.nh, IFLA_LINKINFO, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_INFO_KIND, "bridge", strlen("bridge"));
+        data = vnetNetlinkAttr(&req.nh, IFLA_INFO_DATA, NULL, 0);
+        vnetNetlinkAttr(&req.nh, IFLA_BR_STP_STATE, &state, sizeof(state));
+        vnetNetlinkNestEnd(&req.nh, data);
+        vnetNetlinkNestEnd(&req.nh, info);
+        if (vnetNetlinkTalk(&req.nh) == 0)
+            return (EUCA_OK);
     }
+#endif /* IFLA_BR_MAX */
+    return ((vnetRootwrap(vnetconfig, "brctl stp %s %s", brname, ((on) ? "on" : "off")) == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
 
-    if (((vnetconfig->role == CC) || (vnetconfig->role == CLC)) && (!strcmp(vnetconfig->mode, NETMODE_MANAGED) || !strcmp(vnetconfig->mode, NETMODE_MANAGED_NOVLAN))) {
-        snprintf(cmd, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP " ip addr add %s/32 dev %s", vnetconfig->eucahome, src, vnetconfig->pubInterface);
-        LOGDEBUG("running cmd %s\n", cmd);
-        rc = system(cmd);
-        rc = rc >> 8;
-        if (rc && (rc != 2)) {
-            LOGERROR("failed to assign IP address '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
-        
-        network = hex2dot(vnetconfig->nw);
-        slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->nm)) + 1);
-        snprintf(cmd, EUCA_MAX_PATH, "-A PREROUTING -s %s/%d -d %s -j MARK --set-xmark 0x15/0xffffffff", network, slashnet, src);
-        EUCA_FREE(network);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "nat", cmd)) != 0) {
-            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
+//!
+//! Makes an interface a port of a bridge, like 'brctl addif' does
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] brname the bridge
+//! @param[in] dev the interface
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetLinkSetMaster(vnetConfig * vnetconfig, const char *brname, const char *dev)
+{
+    int ifindex = if_nametoindex(dev);
+    int master = if_nametoindex(brname);
+    vnetNetlinkReq req;
+
+    if ((ifindex > 0) && (master > 0)) {
+        vnetNetlinkLinkReq(&req, RTM_NEWLINK, 0, ifindex);
+        vnetNetlinkAttr(&req.nh, IFLA_MASTER, &master, sizeof(master));
+        if (vnetNetlinkTalk(&req.nh) == 0)
+            return (EUCA_OK);
+    }
+    return ((vnetRootwrap(vnetconfig, "brctl addif %s %s", brname, dev) == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
 
-        snprintf(cmd, EUCA_MAX_PATH, "-A PREROUTING -d %s -j DNAT --to-destination %s", src, dst);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "nat", cmd)) != 0) {
-            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
+//!
+//! Brings an interface up or down, like 'ip link set dev <dev> up|down' does
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] dev the interface
+//! @param[in] up set to TRUE to bring it up
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetLinkSetUp(vnetConfig * vnetconfig, const char *dev, boolean up)
+{
+    int ifindex = if_nametoindex(dev);
+    struct ifinfomsg *ifi = NULL;
+    vnetNetlinkReq req;
+
+    if (ifindex > 0) {
+        ifi = vnetNetlinkLinkReq(&req, RTM_NEWLINK, 0, ifindex);
+        ifi->ifi_change = IFF_UP;
+        ifi->ifi_flags = (up) ? (IFF_UP) : (0);
+        if (vnetNetlinkTalk(&req.nh) == 0)
+            return (EUCA_OK);
+    }
+    return ((vnetRootwrap(vnetconfig, "ip link set dev %s %s", dev, ((up) ? "up" : "down")) == 0) ? (EUCA_OK) : (EUCA_ERROR));
+}
 
-        network = hex2dot(vnetconfig->nw);
-        slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->nm)) + 1);
-        snprintf(cmd, EUCA_MAX_PATH, "-A OUTPUT -s %s/%d -d %s -j MARK --set-xmark 0x15/0xffffffff", network, slashnet, src);
-        EUCA_FREE(network);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "nat", cmd)) != 0) {
-            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
+//!
+//! Adds an IPv4 address to an interface or removes it, like 'ip addr add|del' does. Adding
+//! an address that is there already counts as a success, as 'ip' exiting with 2 did.
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] add set to TRUE to add the address, FALSE to remove it
+//! @param[in] dev the interface
+//! @param[in] ip the address
+//! @param[in] slashnet the prefix length
+//! @param[in] broadcast the broadcast address, or 0 for none
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetAddrChange(vnetConfig * vnetconfig, boolean add, const char *dev, u32 ip, int slashnet, u32 broadcast)
+{
+    int rc = 0;
+    int ifindex = if_nametoindex(dev);
+    u32 addr = htonl(ip);
+    u32 bcast = htonl(broadcast);
+    char *ipstr = NULL;
+    char *bcstr = NULL;
+    vnetNetlinkReq req;
+
+    if (ifindex > 0) {
+        memset(&req, 0, sizeof(req));
+        req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+        req.nh.nlmsg_type = (add) ? (RTM_NEWADDR) : (RTM_DELADDR);
+        req.nh.nlmsg_flags = (add) ? (NLM_F_CREATE | NLM_F_EXCL) : (0);
+        req.u.ifa.ifa_family = AF_INET;
+        req.u.ifa.ifa_prefixlen = slashnet;
+        req.u.ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+        req.u.ifa.ifa_index = ifindex;
+        vnetNetlinkAttr(&req.nh, IFA_LOCAL, &addr, sizeof(addr));
+        vnetNetlinkAttr(&req.nh, IFA_ADDRESS, &addr, sizeof(addr));
+        if (broadcast)
+            vnetNetlinkAttr(&req.nh, IFA_BROADCAST, &bcast, sizeof(bcast));
+        if (((rc = vnetNetlinkTalk(&req.nh)) == 0) || (add && (rc == -EEXIST)))
+            return (EUCA_OK);
+    }
 
-        snprintf(cmd, EUCA_MAX_PATH, "-A OUTPUT -d %s -j DNAT --to-destination %s", src, dst);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "nat", cmd)) != 0) {
-            LOGERROR("failed to apply DNAT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
+    ipstr = hex2dot(ip);
+    bcstr = hex2dot(broadcast);
+    if (broadcast)
+        rc = vnetRootwrap(vnetconfig, "ip addr %s %s/%d broadcast %s dev %s", ((add) ? "add" : "del"), ipstr, slashnet, bcstr, dev);
+    else
+        rc = vnetRootwrap(vnetconfig, "ip addr %s %s/%d dev %s", ((add) ? "add" : "del"), ipstr, slashnet, dev);
+    EUCA_FREE(ipstr);
+    EUCA_FREE(bcstr);
+    return ((rc && !(add && (rc == 2))) ? (EUCA_ERROR) : (EUCA_OK));
+}
 
-        slashnet = 32 - ((int)log2((double)(0xFFFFFFFF - vnetconfig->networks[vlan].nm)) + 1);
-        network = hex2dot(vnetconfig->networks[vlan].nw);
-        snprintf(cmd, EUCA_MAX_PATH, "-I POSTROUTING -s %s ! -d %s/%d -j SNAT --to-source %s", dst, network, slashnet, src);
-        EUCA_FREE(network);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "nat", cmd)) != 0) {
-            LOGERROR("failed to apply SNAT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
-        
-        //snprintf(cmd, EUCA_MAX_PATH, "-I POSTROUTING -s %s -d %s -j SNAT --to-source %s", dst, dst, src);
-        snprintf(cmd, EUCA_MAX_PATH, "-I POSTROUTING -s %s -m mark --mark 0x15 -j SNAT --to-source %s", dst, src);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "nat", cmd)) != 0) {
-            LOGERROR("failed to apply SNAT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
-        }
-        // For reporting traffic statistics.
-        snprintf(cmd, EUCA_MAX_PATH, "-A EUCA_COUNTERS_IN -d %s", dst);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "filter", cmd)) != 0) {
-            LOGERROR("vnetAssignAddress(): failed to apply EUCA_COUNTERS_IN rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
+//!
+//! Removes all the addresses of an interface, like 'ip addr flush' does
+//!
+//! @param[in] vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in] dev the interface
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int vnetAddrFlush(vnetConfig * vnetconfig, const char *dev)
+{
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    int ifindex = if_nametoindex(dev);
+    int count = 0;
+    int attrlen = 0;
+    boolean done = FALSE;
+    ssize_t got = 0;
+    char reply[16384] = "";
+    struct nlmsghdr *rh = NULL;
+    struct ifaddrmsg *ifa = NULL;
+    struct rtattr *rta = NULL;
+    struct sockaddr_nl sa = { 0 };
+    vnetNetlinkReq req;
+    vnetNetlinkReq *dels = NULL;
+    vnetNetlinkReq *grown = NULL;
+
+    if ((ifindex > 0) && netlinkAllowed && ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) >= 0)) {
+        // a dump of the addresses first, then a deletion of each one of this interface
+        memset(&req, 0, sizeof(req));
+        req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+        req.nh.nlmsg_type = RTM_GETADDR;
+        req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        req.nh.nlmsg_seq = 1;
+        req.u.ifa.ifa_family = AF_UNSPEC;
+        sa.nl_family = AF_NETLINK;
+        if (sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) >= 0) {
+            ret = EUCA_OK;
+            while (!done && (ret == EUCA_OK) && ((got = recv(fd, reply, sizeof(reply), 0)) > 0)) {
+                for (rh = (struct nlmsghdr *)reply; NLMSG_OK(rh, got); rh = NLMSG_NEXT(rh, got)) {
+                    if ((rh->nlmsg_type == NLMSG_DONE) || (rh->nlmsg_type == NLMSG_ERROR)) {
+                        ret = (rh->nlmsg_type == NLMSG_DONE) ? (EUCA_OK) : (EUCA_ERROR);
+                        done = TRUE;
+                        break;
+                    }
+                    ifa = NLMSG_DATA(rh);
+                    if ((rh->nlmsg_type != RTM_NEWADDR) || (ifa->ifa_index != ifindex))
+                        continue;
+                    if ((grown = EUCA_REALLOC(dels, (count + 1), sizeof(vnetNetlinkReq))) == NULL) {
+                        ret = EUCA_ERROR;
+                        break;
+                    }
+                    dels = grown;
+                    memset(&dels[count], 0, sizeof(vnetNetlinkReq));
+                    dels[count].nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+                    dels[count].nh.nlmsg_type = RTM_DELADDR;
+                    dels[count].u.ifa = *ifa;
+                    attrlen = IFA_PAYLOAD(rh);
+                    for (rta = IFA_RTA(ifa); RTA_OK(rta, attrlen); rta = RTA_NEXT(rta, attrlen)) {
+                        if ((rta->rta_type == IFA_LOCAL) || (rta->rta_type == IFA_ADDRESS))
+                            vnetNetlinkAttr(&dels[count].nh, rta->rta_type, RTA_DATA(rta), RTA_PAYLOAD(rta));
+                    }
+                    count++;
+                }
+            }
         }
+        close(fd);
 
-        snprintf(cmd, EUCA_MAX_PATH, "-A EUCA_COUNTERS_OUT -s %s", dst);
-        if ((rc = vnetApplySingleTableRule(vnetconfig, "filter", cmd)) != 0) {
-            LOGERROR("vnetAssignAddress(): failed to apply EUCA_COUNTERS_OUT rule '%s'\n", cmd);
-            ret = EUCA_ERROR;
+        for (int i = 0; (i < count) && (ret == EUCA_OK); i++) {
+            if (vnetNetlinkTalk(&dels[i].nh) != 0)
+                ret = EUCA_ERROR;
         }
+        EUCA_FREE(dels);
+        if (ret == EUCA_OK)
+            return (EUCA_OK);
     }
-    return (ret);
+    return ((vnetRootwrap(vnetconfig, "ip addr flush %s", dev) == 0) ? (EUCA_OK) : (EUCA_ERROR));
 }
 
 //!
@@ -3434,29 +5221,93 @@ int vnetSetPublicIP(vnetConfig * vnetconfig, char *uuid, char *ip, char *dstip,
     }
 
     hip = dot2hex(ip);
-    for (i = 1; i < NUMBER_OF_PUBLIC_IPS; i++) {
-        if (vnetconfig->publicips[i].ip == hip) {
-            if (dstip) {
-                vnetconfig->publicips[i].dstip = dot2hex(dstip);
-            } else {
-                vnetconfig->publicips[i].dstip = 0;
-            }
+    if ((i = vnetFindPublicIP(vnetconfig, hip)) != 0) {
+        if (dstip) {
+            vnetconfig->publicips[i].dstip = dot2hex(dstip);
+        } else {
+            vnetconfig->publicips[i].dstip = 0;
+        }
 
-            vnetconfig->publicips[i].allocated = setval;
-            if (uuid) {
-                if (setval) {
-                    snprintf(vnetconfig->publicips[i].uuid, 48, "%s", uuid);
-                } else {
-                    bzero(vnetconfig->publicips[i].uuid, sizeof(char) * 48);
-                }
+        vnetconfig->publicips[i].allocated = setval;
+        if (uuid) {
+            if (setval) {
+                snprintf(vnetconfig->publicips[i].uuid, 48, "%s", uuid);
             } else {
                 bzero(vnetconfig->publicips[i].uuid, sizeof(char) * 48);
             }
-            return (EUCA_OK);
+        } else {
+            bzero(vnetconfig->publicips[i].uuid, sizeof(char) * 48);
         }
+        vnetTouchPublicIP(vnetconfig, i);
     }
     return (EUCA_OK);
+}
+
+//!
+//! Reports the slots of the public IP pool that changed since a previous call. With a \p since
+//! of 0, every slot holding an address is reported; otherwise the slots changed after \p since,
+//! including the ones whose address was removed (addr.ip is 0), are.
+//!
+//! @param[in]  vnetconfig a pointer to the Virtual Network Configuration information structure
+//! @param[in]  since the \p outSeq a previous call returned or 0 for the whole pool
+//! @param[out] outDeltas the changed slots, in slot order, to be freed by the caller (NULL if none)
+//! @param[out] outLen the number of entries in \p outDeltas
+//! @param[out] outSeq the cursor to pass as \p since on the next call
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_MEMORY_ERROR: if we fail to allocate \p outDeltas
+//!
+//! @pre \p vnetconfig, \p outDeltas, \p outLen and \p outSeq must not be NULL.
+//!
+//! @note the caller holds the lock protecting \p vnetconfig
+//!
+int vnetDescribePublicIPs(vnetConfig * vnetconfig, u32 since, publicipDelta ** outDeltas, int *outLen, u32 * outSeq)
+{
+    int i = 0;
+    int count = 0;
+    publicipDelta *deltas = NULL;
+
+    if (!vnetconfig || !outDeltas || !outLen || !outSeq) {
+        LOGERROR("bad input params: vnetconfig=%p, outDeltas=%p, outLen=%p, outSeq=%p\n", vnetconfig, outDeltas, outLen, outSeq);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    *outDeltas = NULL;
+    *outLen = 0;
+    *outSeq = vnetconfig->publicipSeq;
+
+    // a cursor from before the pool was reset (or wrapped) gets the whole pool again
+    if (since > vnetconfig->publicipSeq)
+        since = 0;
+
+    if (since == vnetconfig->publicipSeq)
+        return (EUCA_OK);
+
+    for (i = 1; i < NUMBER_OF_PUBLIC_IPS; i++) {
+        if ((since == 0) ? (vnetconfig->publicips[i].ip != 0) : (vnetconfig->publicips[i].changeSeq > since))
+            count++;
+    }
+
+    if (count == 0)
+        return (EUCA_OK);
+
+    if ((deltas = EUCA_ZALLOC(count, sizeof(publicipDelta))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    for (i = 1, count = 0; i < NUMBER_OF_PUBLIC_IPS; i++) {
+        if ((since == 0) ? (vnetconfig->publicips[i].ip != 0) : (vnetconfig->publicips[i].changeSeq > since)) {
+            deltas[count].idx = i;
+            deltas[count].addr = vnetconfig->publicips[i];
+            count++;
+        }
+    }
 
+    *outDeltas = deltas;
+    *outLen = count;
+    return (EUCA_OK);
 }
 
 //!
@@ -3480,12 +5331,12 @@ int vnetSetPublicIP(vnetConfig * vnetconfig, char *uuid, char *ip, char *dstip,
 //!
 int vnetReassignAddress(vnetConfig * vnetconfig, char *uuid, char *src, char *dst, int vlan)
 {
-    int i = 0;
     int isallocated = 0;
     int pubidx = 0;
     int rc = EUCA_OK;
+    u32 moved = 0;
+    u32 *grown = NULL;
     char *currdst = NULL;
-    boolean done = FALSE;
 
     // assign address if unassigned, unassign/reassign if assigned
     if (!vnetconfig || !src || !dst) {
@@ -3493,22 +5344,12 @@ int vnetReassignAddress(vnetConfig * vnetconfig, char *uuid, char *src, char *ds
         return (EUCA_INVALID_ERROR);
     }
     // get the publicIP of interest
-    isallocated = 0;
-    pubidx = 0;
-    currdst = NULL;
-    for (i = 1, done = FALSE; ((i < NUMBER_OF_PUBLIC_IPS) && !done); i++) {
-        if (vnetconfig->publicips[i].ip == dot2hex(src)) {
-            currdst = hex2dot(vnetconfig->publicips[i].dstip);
-            isallocated = vnetconfig->publicips[i].allocated;
-            pubidx = i;
-            done = TRUE;
-        }
-    }
-
-    if (!done) {
+    if ((pubidx = vnetFindPublicIP(vnetconfig, dot2hex(src))) == 0) {
         LOGERROR("could not find ip %s in list of allocateable publicips\n", src);
         return (EUCA_NOT_FOUND_ERROR);
     }
+    currdst = hex2dot(vnetconfig->publicips[pubidx].dstip);
+    isallocated = vnetconfig->publicips[pubidx].allocated;
 
     LOGDEBUG("deciding what to do: src=%s dst=%s allocated=%d currdst=%s\n", SP(src), SP(dst), isallocated, SP(currdst));
     // determine if reassign must happen
@@ -3517,6 +5358,7 @@ int vnetReassignAddress(vnetConfig * vnetconfig, char *uuid, char *src, char *ds
             EUCA_FREE(currdst);
             return (EUCA_ERROR);
         }
+        moved = dot2hex(src);
     }
     // not used anymore
     EUCA_FREE(currdst);
@@ -3533,9 +5375,25 @@ int vnetReassignAddress(vnetConfig * vnetconfig, char *uuid, char *src, char *ds
         vnetconfig->publicips[pubidx].allocated = 1;
     }
 
+    // only now that the new rules are in do the flows of the address go, so none comes back with the old translation
+    if (moved && vnetAssignBatching()) {
+        if (assignBatch.numMovedIps == assignBatch.maxMovedIps) {
+            if ((grown = EUCA_REALLOC(assignBatch.movedIps, (assignBatch.maxMovedIps + 64), sizeof(u32))) != NULL) {
+                assignBatch.movedIps = grown;
+                assignBatch.maxMovedIps += 64;
+            }
+        }
+        if (assignBatch.numMovedIps < assignBatch.maxMovedIps) {
+            assignBatch.movedIps[assignBatch.numMovedIps++] = moved;
+        }
+    } else if (moved) {
+        vnetConntrackDelete(vnetconfig->eucahome, &moved, 1);
+    }
+
     if (uuid) {
         snprintf(vnetconfig->publicips[pubidx].uuid, 48, "%s", uuid);
     }
+    vnetTouchPublicIP(vnetconfig, pubidx);
     LOGDEBUG("successfully set src=%s to dst=%s with uuid=%s, allocated=%d\n", SP(src), SP(dst), SP(uuid), vnetconfig->publicips[pubidx].allocated);
     return (EUCA_OK);
 }
@@ -4370,3 +6228,42 @@ char *host2ip(char *host)
     }
     return (ret);
 }
+
+//!
+//! Tells a local eucanetd that a new version of the global network info is in place, so that it
+//! applies it right away rather than on its next poll. This is a best effort: when eucanetd is
+//! not running or not listening, it still picks the change up by polling.
+//!
+//! @param[in] eucahome the eucalyptus home directory
+//! @param[in] version the version of the network info, the MD5 hash of the file as written (may be NULL)
+//!
+//! @return EUCA_OK if the notification was sent, EUCA_INVALID_ERROR on bad input or EUCA_ERROR otherwise
+//!
+//! @pre \p eucahome must not be NULL
+//!
+int vnetNotifyEucanetd(char *eucahome, char *version)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    struct sockaddr_un addr = { 0 };
+
+    if (!eucahome) {
+        LOGERROR("bad input params: eucahome=%s\n", SP(eucahome));
+        return (EUCA_INVALID_ERROR);
+    }
+
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), EUCANETD_NOTIFY_SOCKET, eucahome);
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0) {
+        LOGWARN("cannot create socket to notify eucanetd: %s\n", strerror(errno));
+        return (EUCA_ERROR);
+    }
+
+    if (sendto(fd, ((version) ? version : ""), ((version) ? strlen(version) : 0), MSG_DONTWAIT, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGDEBUG("could not notify eucanetd on '%s' (%s), it will pick up the change on its next poll\n", addr.sun_path, strerror(errno));
+        ret = EUCA_ERROR;
+    }
+    close(fd);
+    return (ret);
+}
@@ -77,6 +77,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdarg.h>
@@ -97,10 +98,31 @@
 #define NUMBER_OF_NAME_SERVERS                     32
 #define MAX_ETH_DEV_PATH                           16
 #define MAX_SEC_GROUPS                           NUMBER_OF_VLANS
+#define NUMBER_OF_POOLED_ADDRS                   (NUMBER_OF_VLANS * 128)    //!< host entries shared by the networks in use
+#define VNET_ADDRMAP_WORDS                       (NUMBER_OF_HOSTS_PER_VLAN / 32)    //!< words in a per-network host bitmap
+#define VNET_POOLMAP_WORDS                       (NUMBER_OF_VLANS / 32) //!< words in the host entry pool bitmap
+#define VNET_PUBIPMAP_WORDS                      (NUMBER_OF_PUBLIC_IPS / 32)    //!< words in the public IP slot bitmap
+#define VNET_PUBIP_HASH_BITS                     12     //!< log2 of the number of public IP hash buckets
+#define VNET_PUBIP_HASH_SIZE                     (1 << VNET_PUBIP_HASH_BITS)    //!< public IP hash buckets, twice the pool size
 
 #define LOCALHOST_HEX                            0x7F000001
 #define LOCALHOST_STRING                         "127.0.0.1"
 
+#define VNET_DHCP_OMAPI_PORT                     7912   //!< port the DHCP daemons we start take OMAPI host updates on
+#define VNET_DHCP_OMAPI_KEY                      "euca-omapi"   //!< name of the key the OMAPI host updates are signed with
+#define VNET_DHCP_OMAPI_SECRET_LEN               32     //!< base64 digits in the OMAPI key secret
+
+//! @{
+//! @name Forms of the networkInfo of ncBroadcastNetworkInfo besides the base64 encoded XML. Their
+//!       ':' is not a base64 digit, so an NC that does not know them turns them down.
+
+#define NETWORK_INFO_VERSION_PREFIX              "version:" //!< followed by the MD5 of the XML the NC should have already
+#define NETWORK_INFO_ZLIB_PREFIX                 "zlib:"    //!< followed by "<MD5>:<length>:" and the base64 encoded deflated XML
+#define NETWORK_INFO_MAX_XML                     (64 * 1024 * 1024) //!< an inflated XML any larger than this is refused
+#define NETWORK_INFO_VERSION_LEN                 33     //!< room for the hex MD5 that versions a network info XML
+
+//! @}
+
 //! @{
 //! @name Defines the various supported network mode names
 
@@ -113,6 +135,14 @@
 
 //! @}
 
+//! @{
+//! @name Defines the kernel tunnels between the CCs
+
+#define TUNNEL_VXLAN_PORT                        4789   //!< IANA VXLAN port the tunnels use
+#define TUNNEL_VXLAN_VNI_BASE                    0x454300   //!< VNIs of the tunnels, one per pair of CCs, start here
+
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -132,6 +162,13 @@ enum {
     CLC,                               //!< Cloud Controller
 };
 
+//! Defines how the tunnels between the CCs are built (VNET_TUNNEL_MODE)
+enum {
+    TUNNEL_VTUN,                       //!< userspace vtund processes
+    TUNNEL_VXLAN,                      //!< kernel VXLAN devices
+    TUNNEL_GRE,                        //!< kernel GRE (gretap) devices
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
@@ -158,7 +195,9 @@ typedef struct networkEntry_t {
     u32 bc;
     u32 dns;
     u32 router;
-    netEntry addrs[NUMBER_OF_HOSTS_PER_VLAN];
+    int addrBlock;                     //!< (index + 1) of this network's block of host entries in the pool, 0 until the network needs one
+    u32 freeAddrs[VNET_ADDRMAP_WORDS]; //!< bit set for each host index without a MAC assigned
+    u32 readyAddrs[VNET_ADDRMAP_WORDS];    //!< bit set for each host index with a MAC and IP assigned that is not active yet
     time_t createTime;
 } networkEntry;
 
@@ -167,8 +206,16 @@ typedef struct publicip_t {
     u32 dstip;
     int allocated;
     char uuid[48];
+    int hashNext;                      //!< next slot of publicips[] in the same hash bucket, 0 ends the chain
+    u32 changeSeq;                     //!< value of vnetConfig publicipSeq when this slot last changed
 } publicip;
 
+//! A changed slot of the public IP pool as reported by vnetDescribePublicIPs()
+typedef struct publicipDelta_t {
+    int idx;                           //!< the slot index in publicips[]
+    publicip addr;                     //!< the slot contents, addr.ip is 0 if the address was removed
+} publicipDelta;
+
 typedef struct tunnelData_t {
     int localIpId;
     int localIpIdLast;
@@ -176,6 +223,7 @@ typedef struct tunnelData_t {
     time_t ccsTunnelStart[NUMBER_OF_CCS];
     time_t tunpassMtime;
     int tunneling;
+    int mode;                          //!< how the tunnels are built, TUNNEL_VTUN, TUNNEL_VXLAN or TUNNEL_GRE
 } tunnelData;
 
 typedef struct vnetConfig_t {
@@ -198,6 +246,7 @@ typedef struct vnetConfig_t {
     boolean enabled;                   //!< Set to TRUE if this virtual network is enabled. Othersize set to FALSE
     boolean initialized;               //!< Set to TRUE if this virtual network is initialized properly. Otherwise set to FALSE
     int numaddrs;
+    int addrBlockSize;                 //!< host entries per network block in addrPool[] (numaddrs, capped to NUMBER_OF_HOSTS_PER_VLAN)
     int addrIndexMin;
     int addrIndexMax;
     int max_vlan;
@@ -205,7 +254,12 @@ typedef struct vnetConfig_t {
     char etherdevs[NUMBER_OF_VLANS][MAX_ETH_DEV_PATH];
     userEntry users[NUMBER_OF_VLANS];
     networkEntry networks[NUMBER_OF_VLANS];
+    u32 addrPoolMap[VNET_POOLMAP_WORDS];   //!< bit set for each block of addrPool[] owned by a network
+    netEntry addrPool[NUMBER_OF_POOLED_ADDRS];  //!< host entries, handed out to the networks in blocks of addrBlockSize on demand
     publicip publicips[NUMBER_OF_PUBLIC_IPS];
+    u32 publicipMap[VNET_PUBIPMAP_WORDS];  //!< bit set for each slot of publicips[] holding an address
+    int publicipHash[VNET_PUBIP_HASH_SIZE];    //!< first slot of publicips[] whose address hashes to the bucket, 0 if none
+    u32 publicipSeq;                   //!< bumped on every change to publicips[], the cursor of vnetDescribePublicIPs()
     publicip privateips[NUMBER_OF_PRIVATE_IPS];
     char iptables[4194304];
 } vnetConfig;
@@ -232,12 +286,14 @@ int vnetSetMetadataRedirect(vnetConfig * vnetconfig);
 int vnetUnsetMetadataRedirect(vnetConfig * vnetconfig);
 
 int vnetInitTunnels(vnetConfig * vnetconfig);
+int vnetSetTunnelMode(vnetConfig * vnetconfig, const char *mode);
 
 int vnetAddHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int idx);
 int vnetDelHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan);
 int vnetRefreshHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan, int idx);
 int vnetEnableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan);
 int vnetDisableHost(vnetConfig * vnetconfig, char *mac, char *ip, int vlan);
+netEntry *vnetGetAddrs(vnetConfig * vnetconfig, int vlan);
 
 int vnetDeleteChain(vnetConfig * vnetconfig, char *userName, char *netName);
 int vnetCreateChain(vnetConfig * vnetconfig, char *userName, char *netName);
@@ -262,6 +318,10 @@ int vnetDelDev(vnetConfig * vnetconfig, char *dev);
 
 int vnetGenerateDHCP(vnetConfig * vnetconfig, int *numHosts);
 int vnetKickDHCP(vnetConfig * vnetconfig);
+char *vnetGetDHCPOmapiSecret(char *path);
+void vnetPrintDHCPOmapiConf(FILE * fp, char *path);
+int vnetUpdateDHCPHosts(char *path);
+void vnetRecordDHCPConf(char *path);
 
 int vnetAddCCS(vnetConfig * vnetconfig, u32 cc);
 int vnetDelCCS(vnetConfig * vnetconfig, u32 cc);
@@ -275,6 +335,8 @@ int vnetTeardownTunnels(vnetConfig * vnetconfig);
 int vnetTeardownTunnelsVTUN(vnetConfig * vnetconfig);
 int vnetSetupTunnels(vnetConfig * vnetconfig);
 int vnetSetupTunnelsVTUN(vnetConfig * vnetconfig);
+int vnetTeardownTunnelsKernel(vnetConfig * vnetconfig);
+int vnetSetupTunnelsKernel(vnetConfig * vnetconfig);
 
 int vnetAddGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int localIpId);
 int vnetDelGatewayIP(vnetConfig * vnetconfig, int vlan, char *devname, int localIpId);
@@ -287,9 +349,13 @@ int vnetCheckPublicIP(vnetConfig * vnetconfig, char *ip);
 int vnetAddPublicIP(vnetConfig * vnetconfig, char *inip);
 int vnetAddPrivateIP(vnetConfig * vnetconfig, char *inip);
 int vnetAssignAddress(vnetConfig * vnetconfig, char *src, char *dst, int vlan);
+int vnetAssignBatchBegin(vnetConfig * vnetconfig);
+int vnetAssignBatchCommit(vnetConfig * vnetconfig);
+int vnetConntrackDelete(const char *eucahome, const u32 * ips, int numIps);
 int vnetAllocatePublicIP(vnetConfig * vnetconfig, char *uuid, char *ip, char *dstip);
 int vnetDeallocatePublicIP(vnetConfig * vnetconfig, char *uuid, char *ip, char *dstip);
 int vnetSetPublicIP(vnetConfig * vnetconfig, char *uuid, char *ip, char *dstip, int setval);
+int vnetDescribePublicIPs(vnetConfig * vnetconfig, u32 since, publicipDelta ** outDeltas, int *outLen, u32 * outSeq);
 int vnetReassignAddress(vnetConfig * vnetconfig, char *uuid, char *src, char *dst, int vlan);
 int vnetUnassignAddress(vnetConfig * vnetconfig, char *src, char *dst, int vlan);
 
@@ -311,6 +377,7 @@ int check_bridge(char *brname);
 int check_tablerule(vnetConfig * vnetconfig, char *table, char *rule);
 int check_isip(char *ip);
 char *host2ip(char *host);
+int vnetNotifyEucanetd(char *eucahome, char *version);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
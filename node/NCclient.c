@@ -687,11 +687,17 @@ static int ncClientPowerDown(ncStub * pStub, ncMetadata * pMeta)
 //!
 static int ncClientBroadcastNetworkInfo(ncStub * pStub, ncMetadata * pMeta, char *psNetworkInfo)
 {
-    char *networkInfoBuf = NULL;
     int rc = EUCA_OK;
-    networkInfoBuf = file2str(psNetworkInfo);
-    rc = ncBroadcastNetworkInfoStub(pStub, pMeta, networkInfoBuf);
-    printf("ncBroadcastNetworkInfoStub = %d, %s\n", rc, networkInfoBuf);
+    file_view networkInfo = { 0 };
+
+    if (file_view_open(psNetworkInfo, -1, &networkInfo) != EUCA_OK) {
+        printf("cannot read network information from %s\n", psNetworkInfo);
+        return (EUCA_ERROR);
+    }
+
+    rc = ncBroadcastNetworkInfoStub(pStub, pMeta, networkInfo.data);
+    printf("ncBroadcastNetworkInfoStub = %d, %s\n", rc, networkInfo.data);
+    file_view_close(&networkInfo);
     return (rc);
 }
 
@@ -0,0 +1,793 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file node/NCload.c
+//! Multi-threaded load generator for a node controller
+//!
+//! NCload issues a mix of DescribeInstances, DescribeResource, DescribeSensors, RunInstance
+//! and TerminateInstance requests to the NC at <host:port> through the stubs of
+//! client-marshal-adb.c, from a number of threads, each with its own stub. The instances are
+//! launched from fake images, so that an NC which cannot reach object storage still goes
+//! through the whole RunInstance and TerminateInstance code paths, and every instance left
+//! at the end of the run is terminated.
+//!
+//! With -r 0 (the default) the load is closed-loop: every thread sends its next request as
+//! soon as the previous one returns, and the throughput is what the NC sustains. With -r N
+//! the load is open-loop: the threads together send N requests per second on a fixed
+//! schedule, and a request is timed from the moment it was due rather than from the moment
+//! it was sent, so that an NC falling behind shows up in the latencies instead of slowing
+//! the load down.
+//!
+//! The results are printed as key=value lines:
+//!     \li the settings, duration and total throughput of the run;
+//!     \li the count, failures, throughput and mean, p50, p99, p999 and maximum latencies
+//!         of every operation, in microseconds.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <eucalyptus.h>
+#include <misc.h>
+#include <euca_axis.h>
+#include <euca_string.h>
+#include <data.h>
+#include <sensor.h>
+
+#include "client-marshal.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define NC_ENDPOINT                 "/axis2/services/EucalyptusNC"
+#define WALRUS_ENDPOINT             "/services/Walrus"
+#define DEFAULT_WALRUS_HOSTPORT     "localhost:8773"
+#define DEFAULT_NC_HOSTPORT         "localhost:8775"
+
+#define LOAD_MAX_THREADS                         256    //!< Maximum number of request threads
+#define LOAD_MAX_POOL                           1024    //!< Maximum number of launched instances tracked for termination
+#define LOAD_STUB_REQUESTS                       256    //!< Requests sent through a stub before it is replaced, see load_worker()
+#define LOAD_SAMPLES                            4096    //!< Initial size of the latency sample arrays, grown as needed
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Operations issued to the NC, in the order of the -m weights
+enum {
+    LOAD_DESCRIBE_INSTANCES,
+    LOAD_DESCRIBE_RESOURCE,
+    LOAD_DESCRIBE_SENSORS,
+    LOAD_RUN,
+    LOAD_TERMINATE,
+    LOAD_OPS,
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Latencies of one operation, as measured by one thread
+typedef struct loadSamples_t {
+    long long *usec;                   //!< the latencies, in microseconds
+    int len;                           //!< number of entries in usec[]
+    int size;                          //!< allocated size of usec[]
+    long long failures;                //!< number of requests that failed
+} loadSamples;
+
+//! State of one request thread
+typedef struct loadWorker_t {
+    pthread_t thread;                  //!< the thread
+    int index;                         //!< index of the thread, 0 to threads - 1
+    unsigned int seed;                 //!< rand_r() state
+    int requests;                      //!< requests sent through the current stub
+    ncStub *stub;                      //!< NC stub of this thread
+    loadSamples samples[LOAD_OPS];     //!< latencies, by operation
+} loadWorker;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#ifndef NO_COMP
+const char *euca_this_component_name = "nc";    //!< Eucalyptus Component Name
+const char *euca_client_component_name = "user";    //!< The client component name
+#endif /* ! NO_COMP */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static const char *load_op_names[LOAD_OPS] = { "DescribeInstances", "DescribeResource", "DescribeSensors", "RunInstance", "TerminateInstance" };
+
+//! @{
+//! @name Settings, from the command line
+static int load_threads = 4;           //!< number of request threads
+static double load_rate = 0.0;         //!< target request rate of all threads together, per second, 0 for closed-loop
+static int load_duration = 60;         //!< length of the run, in seconds
+static int load_weights[LOAD_OPS] = { 6, 2, 1, 1, 1 };  //!< operation mix
+static int load_weights_total = 11;    //!< sum of load_weights[]
+static boolean load_wssec = FALSE;     //!< whether the stubs use WS-Security
+static char load_url[EUCA_MAX_PATH] = "";   //!< NC endpoint
+static char load_policy_file[EUCA_MAX_PATH] = "";   //!< WS-Security policy of the stubs
+static char load_image_url[EUCA_MAX_PATH] = ""; //!< manifest URL of the fake machine image
+static char load_kernel_url[EUCA_MAX_PATH] = "";    //!< manifest URL of the fake kernel
+static char load_ramdisk_url[EUCA_MAX_PATH] = "";   //!< manifest URL of the fake ramdisk
+//! @}
+
+//! @{
+//! @name Shared state of the request threads
+static volatile int load_running = 1;  //!< cleared when the run is over
+static ncMetadata load_meta = { 0 };   //!< request metadata, read-only once the threads run
+static pthread_mutex_t load_stub_lock = PTHREAD_MUTEX_INITIALIZER;  //!< serializes ncStubCreate() and InitWSSEC()
+static pthread_mutex_t load_pool_lock = PTHREAD_MUTEX_INITIALIZER;  //!< protects load_pool[] and load_pool_len
+static char load_pool[LOAD_MAX_POOL][CHAR_BUFFER_SIZE]; //!< instances launched and not yet terminated
+static int load_pool_len = 0;          //!< number of entries in load_pool[]
+static long long load_instances_seen = 0;   //!< sum of the instance counts returned by DescribeInstances
+//! @}
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void usage(void);
+static ncStub *load_stub_create(void);
+static void pool_add(const char *instanceId);
+static int pool_take(loadWorker * w, char *instanceId, int len);
+static int load_describe_instances(loadWorker * w);
+static int load_describe_resource(loadWorker * w);
+static int load_describe_sensors(loadWorker * w);
+static int load_run_instance(loadWorker * w);
+static int load_terminate_instance(loadWorker * w, const char *instanceId);
+static int load_record(loadSamples * s, long long usec, boolean failed);
+static void *load_worker(void *arg);
+static int compare_usec(const void *a, const void *b);
+static void print_samples(const char *prefix, loadWorker * workers, int op, double seconds);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Prints the usage of the application
+//!
+static void usage(void)
+{
+    fprintf(stderr, "USAGE: NCload [-n host:port] [-w host:port] [-B] [-l] [-t threads] [-r requests/s] [-d seconds]\n"
+            "              [-m describeInstances:describeResource:describeSensors:run:terminate]\n"
+            "\n"
+            "  drives the NC at -n (default %s), launching instances from fake images on the\n"
+            "  object storage at -w (default %s); -B targets the broker endpoint, -l disables\n"
+            "  WS-Security, -r 0 (the default) sends requests back to back from every thread\n", DEFAULT_NC_HOSTPORT, DEFAULT_WALRUS_HOSTPORT);
+}
+
+//!
+//! Creates an NC stub for the endpoint and the security settings of the run
+//!
+//! @return the stub or NULL on failure
+//!
+static ncStub *load_stub_create(void)
+{
+    ncStub *pStub = NULL;
+
+    pthread_mutex_lock(&load_stub_lock);
+    if ((pStub = ncStubCreate(load_url, NULL, NULL)) != NULL) {
+        if (load_wssec && (InitWSSEC(pStub->env, pStub->stub, load_policy_file) != 0)) {
+            fprintf(stderr, "cannot initialize WS-SEC policy from %s\n", load_policy_file);
+            ncStubDestroy(pStub);
+            pStub = NULL;
+        }
+    }
+    pthread_mutex_unlock(&load_stub_lock);
+    return (pStub);
+}
+
+//!
+//! Remembers an instance launched by the run, for a later TerminateInstance
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+static void pool_add(const char *instanceId)
+{
+    pthread_mutex_lock(&load_pool_lock);
+    if (load_pool_len < LOAD_MAX_POOL) {
+        euca_strncpy(load_pool[load_pool_len++], instanceId, CHAR_BUFFER_SIZE);
+    }
+    pthread_mutex_unlock(&load_pool_lock);
+}
+
+//!
+//! Removes a random instance from the pool of launched instances
+//!
+//! @param[in]  w the calling thread
+//! @param[out] instanceId buffer receiving the instance identifier
+//! @param[in]  len size of the instanceId buffer
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if the pool is empty
+//!
+static int pool_take(loadWorker * w, char *instanceId, int len)
+{
+    int i = 0;
+    int ret = EUCA_NOT_FOUND_ERROR;
+
+    pthread_mutex_lock(&load_pool_lock);
+    if (load_pool_len > 0) {
+        i = rand_r(&(w->seed)) % load_pool_len;
+        euca_strncpy(instanceId, load_pool[i], len);
+        euca_strncpy(load_pool[i], load_pool[--load_pool_len], CHAR_BUFFER_SIZE);
+        ret = EUCA_OK;
+    }
+    pthread_mutex_unlock(&load_pool_lock);
+    return (ret);
+}
+
+//!
+//! Describes all instances of the NC
+//!
+//! @param[in] w the calling thread
+//!
+//! @return the result of ncDescribeInstancesStub()
+//!
+static int load_describe_instances(loadWorker * w)
+{
+    int i = 0;
+    int rc = EUCA_OK;
+    int outInstsLen = 0;
+    ncInstance **ppOutInsts = NULL;
+
+    if ((rc = ncDescribeInstancesStub(w->stub, &load_meta, NULL, 0, &ppOutInsts, &outInstsLen)) == EUCA_OK) {
+        __sync_fetch_and_add(&load_instances_seen, outInstsLen);
+        for (i = 0; i < outInstsLen; i++) {
+            free_instance(&(ppOutInsts[i]));
+        }
+    }
+    EUCA_FREE(ppOutInsts);
+    return (rc);
+}
+
+//!
+//! Describes the resources of the NC
+//!
+//! @param[in] w the calling thread
+//!
+//! @return the result of ncDescribeResourceStub()
+//!
+static int load_describe_resource(loadWorker * w)
+{
+    int rc = EUCA_OK;
+    ncResource *pOutRes = NULL;
+
+    rc = ncDescribeResourceStub(w->stub, &load_meta, "TYPE", &pOutRes);
+    EUCA_FREE(pOutRes);
+    return (rc);
+}
+
+//!
+//! Describes the sensors of all instances of the NC, with the history NCclient asks for
+//!
+//! @param[in] w the calling thread
+//!
+//! @return the result of ncDescribeSensorsStub()
+//!
+static int load_describe_sensors(loadWorker * w)
+{
+    int i = 0;
+    int rc = EUCA_OK;
+    int nbResources = 0;
+    sensorResource **ppResources = NULL;
+
+    if ((rc = ncDescribeSensorsStub(w->stub, &load_meta, 20, 5000, NULL, 0, NULL, 0, &ppResources, &nbResources)) == EUCA_OK) {
+        for (i = 0; i < nbResources; i++) {
+            EUCA_FREE(ppResources[i]);
+        }
+    }
+    EUCA_FREE(ppResources);
+    return (rc);
+}
+
+//!
+//! Launches one instance from the fake images and adds it to the pool
+//!
+//! @param[in] w the calling thread
+//!
+//! @return the result of ncRunInstanceStub()
+//!
+static int load_run_instance(loadWorker * w)
+{
+    int rc = EUCA_OK;
+    char instanceId[CHAR_BUFFER_SIZE] = "";
+    char reservationId[CHAR_BUFFER_SIZE] = "";
+    char uuid[CHAR_BUFFER_SIZE] = "";
+    netConfig netParams = { 0 };
+    ncInstance *pOutInst = NULL;
+    virtualMachine params = { 64, 1, 1, "m1.small", NULL, NULL, NULL, NULL, NULL, NULL, {}, 0 };
+
+    snprintf(instanceId, sizeof(instanceId), "i-%08x", rand_r(&(w->seed)));
+    snprintf(reservationId, sizeof(reservationId), "r-%08x", rand_r(&(w->seed)));
+    snprintf(uuid, sizeof(uuid), "%08x-%04x-%04x-%04x-%08x%04x", rand_r(&(w->seed)), (rand_r(&(w->seed)) & 0xFFFF), (rand_r(&(w->seed)) & 0xFFFF),
+             (rand_r(&(w->seed)) & 0xFFFF), rand_r(&(w->seed)), (rand_r(&(w->seed)) & 0xFFFF));
+
+    netParams.vlan = 10;
+    snprintf(netParams.privateIp, sizeof(netParams.privateIp), "10.%d.%d.%d", (rand_r(&(w->seed)) & 0xFF), (rand_r(&(w->seed)) & 0xFF), ((rand_r(&(w->seed)) % 253) + 1));
+    snprintf(netParams.privateMac, sizeof(netParams.privateMac), "d0:0d:%02x:%02x:%02x:%02x", (rand_r(&(w->seed)) & 0xFF), (rand_r(&(w->seed)) & 0xFF),
+             (rand_r(&(w->seed)) & 0xFF), (rand_r(&(w->seed)) & 0xFF));
+
+    rc = ncRunInstanceStub(w->stub, &load_meta, uuid, instanceId, reservationId, &params, "emi-00000001", load_image_url, "eki-00000001", load_kernel_url, "eri-00000001",
+                           load_ramdisk_url, "ncload", "ncload", "", &netParams, "", NULL, "0", NULL, 0, NULL, 0, "", &pOutInst);
+    if (rc == EUCA_OK) {
+        pool_add(instanceId);
+    }
+    EUCA_FREE(pOutInst);
+    return (rc);
+}
+
+//!
+//! Terminates an instance launched by the run
+//!
+//! @param[in] w the calling thread
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+//! @return the result of ncTerminateInstanceStub()
+//!
+static int load_terminate_instance(loadWorker * w, const char *instanceId)
+{
+    int shutdownState = 0;
+    int previousState = 0;
+
+    return (ncTerminateInstanceStub(w->stub, &load_meta, ((char *)instanceId), 0, &shutdownState, &previousState));
+}
+
+//!
+//! Adds one request to the latencies of an operation
+//!
+//! @param[in] s the latencies of the operation
+//! @param[in] usec time the request took
+//! @param[in] failed TRUE if the request failed
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR if the sample array could not grow
+//!
+static int load_record(loadSamples * s, long long usec, boolean failed)
+{
+    long long *grown = NULL;
+
+    if (failed)
+        s->failures++;
+
+    if (s->len == s->size) {
+        if ((grown = EUCA_REALLOC(s->usec, (s->size ? (s->size * 2) : LOAD_SAMPLES), sizeof(long long))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        s->usec = grown;
+        s->size = (s->size ? (s->size * 2) : LOAD_SAMPLES);
+    }
+    s->usec[s->len++] = usec;
+    return (EUCA_OK);
+}
+
+//!
+//! Request thread. Picks each operation at random according to load_weights[] and times
+//! it into the thread samples. In closed-loop mode the requests go back to back, in
+//! open-loop mode they are due every load_threads / load_rate seconds and are timed from
+//! the moment they were due.
+//!
+//! The stubs allocate the requests and responses from an arena that only goes back when the
+//! stub is destroyed, so the stub is replaced every LOAD_STUB_REQUESTS requests, outside of
+//! the timed section.
+//!
+//! @param[in] arg the loadWorker of this thread
+//!
+//! @return Always NULL
+//!
+static void *load_worker(void *arg)
+{
+    int op = 0;
+    int rc = 0;
+    int pick = 0;
+    long long now_us = 0;
+    long long start_us = 0;
+    long long next_us = 0;
+    long long period_us = ((load_rate > 0) ? (long long)((1000000.0 * load_threads) / load_rate) : 0);
+    char instanceId[CHAR_BUFFER_SIZE] = "";
+    loadWorker *w = (loadWorker *) arg;
+    struct timespec ts = { 0 };
+
+    // spread the threads over one period so that they do not fire in lockstep
+    next_us = time_usec() + (period_us * w->index) / load_threads;
+    while (load_running) {
+        if (w->requests >= LOAD_STUB_REQUESTS) {
+            ncStubDestroy(w->stub);
+            if ((w->stub = load_stub_create()) == NULL) {
+                fprintf(stderr, "thread %d cannot replace its stub, stopping it\n", w->index);
+                break;
+            }
+            w->requests = 0;
+        }
+
+        if (period_us > 0) {
+            if ((now_us = time_usec()) < next_us) {
+                ts.tv_sec = (next_us - now_us) / 1000000;
+                ts.tv_nsec = ((next_us - now_us) % 1000000) * 1000;
+                nanosleep(&ts, NULL);
+                continue;
+            }
+            start_us = next_us;
+            next_us += period_us;
+        } else {
+            start_us = time_usec();
+        }
+
+        pick = rand_r(&(w->seed)) % load_weights_total;
+        for (op = 0; (op < (LOAD_OPS - 1)) && (pick >= load_weights[op]); op++)
+            pick -= load_weights[op];
+
+        switch (op) {
+        case LOAD_DESCRIBE_INSTANCES:
+            rc = load_describe_instances(w);
+            break;
+        case LOAD_DESCRIBE_RESOURCE:
+            rc = load_describe_resource(w);
+            break;
+        case LOAD_DESCRIBE_SENSORS:
+            rc = load_describe_sensors(w);
+            break;
+        case LOAD_RUN:
+            rc = load_run_instance(w);
+            break;
+        case LOAD_TERMINATE:
+            // nothing launched yet, launch instead so that the request rate holds
+            if (pool_take(w, instanceId, sizeof(instanceId)) == EUCA_OK) {
+                rc = load_terminate_instance(w, instanceId);
+            } else {
+                op = LOAD_RUN;
+                rc = load_run_instance(w);
+            }
+            break;
+        }
+        w->requests++;
+
+        if (load_record(&(w->samples[op]), (time_usec() - start_us), (rc != EUCA_OK)) != EUCA_OK) {
+            fprintf(stderr, "thread %d is out of memory for its samples, stopping it\n", w->index);
+            break;
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! qsort() comparator of latencies
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return -1, 0 or 1 as a is lower, equal or higher than b
+//!
+static int compare_usec(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints the throughput, failures and latencies of one operation over all threads
+//!
+//! @param[in] prefix key prefix
+//! @param[in] workers the request threads
+//! @param[in] op the operation
+//! @param[in] seconds length of the run, for the throughput
+//!
+static void print_samples(const char *prefix, loadWorker * workers, int op, double seconds)
+{
+    int i = 0;
+    int len = 0;
+    long long failures = 0;
+    long long total = 0;
+    long long *all = NULL;
+    loadSamples *s = NULL;
+
+    for (i = 0; i < load_threads; i++) {
+        len += workers[i].samples[op].len;
+    }
+    if ((len == 0) || ((all = EUCA_ZALLOC(len, sizeof(long long))) == NULL))
+        return;
+
+    for (i = 0, len = 0; i < load_threads; i++) {
+        s = &(workers[i].samples[op]);
+        memcpy(all + len, s->usec, (s->len * sizeof(long long)));
+        len += s->len;
+        failures += s->failures;
+    }
+    qsort(all, len, sizeof(long long), compare_usec);
+    for (i = 0; i < len; i++) {
+        total += all[i];
+    }
+
+    printf("%s.count=%d\n", prefix, len);
+    printf("%s.failures=%lld\n", prefix, failures);
+    printf("%s.throughput=%.2f\n", prefix, ((seconds > 0) ? (len / seconds) : 0.0));
+    printf("%s.mean_us=%.1f\n", prefix, ((double)total / len));
+    printf("%s.p50_us=%lld\n", prefix, all[(int)(0.50 * (len - 1))]);
+    printf("%s.p99_us=%lld\n", prefix, all[(int)(0.99 * (len - 1))]);
+    printf("%s.p999_us=%lld\n", prefix, all[(int)(0.999 * (len - 1))]);
+    printf("%s.max_us=%lld\n", prefix, all[len - 1]);
+    EUCA_FREE(all);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int ch = 0;
+    int op = 0;
+    int left = 0;
+    long long count = 0;
+    long long start_ms = 0;
+    double seconds = 0.0;
+    boolean local = FALSE;
+    char *home = NULL;
+    char *tmpstr = NULL;
+    char *psNcHostPort = DEFAULT_NC_HOSTPORT;
+    char *psWsHostPort = DEFAULT_WALRUS_HOSTPORT;
+    char *psNcEndpoint = NC_ENDPOINT;
+    char configFile[EUCA_MAX_PATH] = "";
+    char prefix[64] = "";
+    char instanceId[CHAR_BUFFER_SIZE] = "";
+    serviceInfoType *pServInfo = NULL;
+    loadWorker *workers = NULL;
+
+    while ((ch = getopt(argc, argv, "n:w:Blt:r:d:m:h")) != -1) {
+        switch (ch) {
+        case 'n':
+            psNcHostPort = optarg;
+            break;
+        case 'w':
+            psWsHostPort = optarg;
+            break;
+        case 'B':
+            psNcEndpoint = "/services/EucalyptusBroker";
+            break;
+        case 'l':
+            local = TRUE;
+            break;
+        case 't':
+            load_threads = atoi(optarg);
+            break;
+        case 'r':
+            load_rate = atof(optarg);
+            break;
+        case 'd':
+            load_duration = atoi(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d:%d:%d:%d", &load_weights[LOAD_DESCRIBE_INSTANCES], &load_weights[LOAD_DESCRIBE_RESOURCE], &load_weights[LOAD_DESCRIBE_SENSORS],
+                       &load_weights[LOAD_RUN], &load_weights[LOAD_TERMINATE]) != LOAD_OPS) {
+                usage();
+                return (EUCA_ERROR);
+            }
+            break;
+        default:
+            usage();
+            return (EUCA_ERROR);
+        }
+    }
+
+    if ((optind != argc) || (load_threads < 1) || (load_threads > LOAD_MAX_THREADS) || (load_rate < 0) || (load_duration < 1)) {
+        usage();
+        return (EUCA_ERROR);
+    }
+
+    for (i = 0, load_weights_total = 0; i < LOAD_OPS; i++) {
+        load_weights[i] = MAX(0, load_weights[i]);
+        load_weights_total += load_weights[i];
+    }
+    if (load_weights_total == 0) {
+        fprintf(stderr, "the operation mix is empty\n");
+        return (EUCA_ERROR);
+    }
+
+    if ((home = getenv(EUCALYPTUS_ENV_VAR_NAME)) == NULL)
+        home = "";
+    snprintf(configFile, sizeof(configFile), EUCALYPTUS_CONF_LOCATION, home);
+    snprintf(load_policy_file, sizeof(load_policy_file), EUCALYPTUS_POLICIES_DIR "/nc-client-policy.xml", home);
+    load_wssec = !local;
+    if ((get_conf_var(configFile, "ENABLE_WS_SECURITY", &tmpstr) == 1) && strcmp(tmpstr, "Y")) {
+        load_wssec = FALSE;
+    }
+    EUCA_FREE(tmpstr);
+
+    snprintf(load_url, sizeof(load_url), "http://%s%s", psNcHostPort, psNcEndpoint);
+    snprintf(load_image_url, sizeof(load_image_url), "http://%s%s/ncload/machine.manifest.xml", psWsHostPort, WALRUS_ENDPOINT);
+    snprintf(load_kernel_url, sizeof(load_kernel_url), "http://%s%s/ncload/kernel.manifest.xml", psWsHostPort, WALRUS_ENDPOINT);
+    snprintf(load_ramdisk_url, sizeof(load_ramdisk_url), "http://%s%s/ncload/ramdisk.manifest.xml", psWsHostPort, WALRUS_ENDPOINT);
+
+    pServInfo = &(load_meta.services[load_meta.servicesLen++]);
+    euca_strncpy(pServInfo->type, "objectstorage", sizeof(pServInfo->type));
+    euca_strncpy(pServInfo->name, "objectstorage", sizeof(pServInfo->name));
+    snprintf(pServInfo->uris[0], sizeof(pServInfo->uris[0]), "http://%s%s", psWsHostPort, WALRUS_ENDPOINT);
+    pServInfo->urisLen = 1;
+    load_meta.correlationId = strdup("ncload");
+    load_meta.userId = strdup("eucalyptus");
+
+    if ((workers = EUCA_ZALLOC(load_threads, sizeof(loadWorker))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return (EUCA_ERROR);
+    }
+
+    euca_srand();
+    for (i = 0; i < load_threads; i++) {
+        workers[i].index = i;
+        workers[i].seed = rand();
+        if ((workers[i].stub = load_stub_create()) == NULL) {
+            fprintf(stderr, "cannot create a stub for %s\n", load_url);
+            return (EUCA_ERROR);
+        }
+    }
+
+    start_ms = time_ms();
+    for (i = 0; i < load_threads; i++) {
+        if (pthread_create(&(workers[i].thread), NULL, load_worker, &(workers[i])) != 0) {
+            fprintf(stderr, "cannot start request thread %d\n", i);
+            load_running = 0;
+            load_threads = i;
+        }
+    }
+
+    while (load_running && ((time_ms() - start_ms) < (load_duration * 1000LL))) {
+        sleep(1);
+    }
+    load_running = 0;
+    for (i = 0; i < load_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    seconds = (time_ms() - start_ms) / 1000.0;
+
+    // leave the NC as we found it, the clean up is not part of the measurements
+    for (left = load_pool_len; (workers[0].stub != NULL) && (pool_take(&(workers[0]), instanceId, sizeof(instanceId)) == EUCA_OK);) {
+        if (load_terminate_instance(&(workers[0]), instanceId) == EUCA_OK)
+            left--;
+    }
+
+    for (i = 0, count = 0; i < load_threads; i++) {
+        for (op = 0; op < LOAD_OPS; op++) {
+            count += workers[i].samples[op].len;
+        }
+    }
+
+    printf("load.threads=%d\n", load_threads);
+    printf("load.target_rate=%.2f\n", load_rate);
+    printf("load.mode=%s\n", ((load_rate > 0) ? "open" : "closed"));
+    printf("load.duration_s=%.1f\n", seconds);
+    printf("load.count=%lld\n", count);
+    printf("load.throughput=%.2f\n", ((seconds > 0) ? (count / seconds) : 0.0));
+    printf("load.instances_described=%lld\n", load_instances_seen);
+    printf("load.instances_left=%d\n", left);
+    for (op = 0; op < LOAD_OPS; op++) {
+        snprintf(prefix, sizeof(prefix), "op.%s", load_op_names[op]);
+        print_samples(prefix, workers, op, seconds);
+    }
+
+    for (i = 0; i < load_threads; i++) {
+        if (workers[i].stub)
+            ncStubDestroy(workers[i].stub);
+        for (op = 0; op < LOAD_OPS; op++) {
+            EUCA_FREE(workers[i].samples[op].usec);
+        }
+    }
+    EUCA_FREE(workers);
+    return (EUCA_OK);
+}
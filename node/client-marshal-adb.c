@@ -92,6 +92,8 @@
 #include <adb-helpers.h>
 #include <sensor.h>
 #include <euca_string.h>
+#include <trace.h>
+#include <euca_axis.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -178,13 +180,26 @@ ncStub *ncStubCreate(char *endpoint_uri, char *logfile, char *homedir)
     axutil_env_t *env = NULL;
     axis2_char_t *client_home = NULL;
     axis2_stub_t *stub = NULL;
+    euca_arena *arena = NULL;
 
     axutil_error_init();               // initialize error strings in Axis2
 
-    if (logfile) {
-        env = axutil_env_create_all(logfile, AXIS2_LOG_LEVEL_TRACE);
-    } else {
-        env = axutil_env_create_all(NULL, 0);
+    // everything Axis2 allocates for this stub, request and response objects included, goes
+    // back at once when the stub is destroyed
+    if ((arena = euca_arena_create(0)) != NULL) {
+        if ((env = euca_arena_env_create(arena, logfile, (logfile ? AXIS2_LOG_LEVEL_TRACE : AXIS2_LOG_LEVEL_CRITICAL))) == NULL) {
+            LOGWARN("failed to create an arena backed Axis2 environment, using malloc()\n");
+            euca_arena_destroy(arena);
+            arena = NULL;
+        }
+    }
+
+    if (env == NULL) {
+        if (logfile) {
+            env = axutil_env_create_all(logfile, AXIS2_LOG_LEVEL_TRACE);
+        } else {
+            env = axutil_env_create_all(NULL, 0);
+        }
     }
 
     if (homedir) {
@@ -239,6 +254,7 @@ ncStub *ncStubCreate(char *endpoint_uri, char *logfile, char *homedir)
             pStub->endpoint_uri = (axis2_char_t *) strdup(endpoint_uri);
             pStub->node_name = (axis2_char_t *) strdup(node_name);
             pStub->stub = stub;
+            pStub->arena = arena;
             if (pStub->client_home == NULL || pStub->endpoint_uri == NULL || pStub->node_name == NULL) {
                 LOGWARN("out of memory (%s:%s:%d client_home=%s endpoint_uri=%s node_name=%s)", __FILE__, __FUNCTION__, __LINE__,
                         pStub->client_home, pStub->endpoint_uri, pStub->node_name);
@@ -266,6 +282,7 @@ int ncStubDestroy(ncStub * pStub)
     if (pStub) {
         axis2_stub_free(pStub->stub, pStub->env);
         axutil_env_free(pStub->env);
+        euca_arena_destroy(pStub->arena);
 
         EUCA_FREE(pStub->client_home);
         EUCA_FREE(pStub->endpoint_uri);
@@ -275,6 +292,33 @@ int ncStubDestroy(ncStub * pStub)
     return (EUCA_OK);
 }
 
+//!
+//! Sets the transport timeout applied to every subsequent call made through an NC stub.
+//! This is what allows a long-lived stub to be used without a watchdog process.
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//! @param[in] timeout the timeout in seconds (must be positive)
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int ncStubSetTimeout(ncStub * pStub, int timeout)
+{
+    axis2_svc_client_t *svc_client = NULL;
+    axis2_options_t *options = NULL;
+
+    if ((pStub == NULL) || (pStub->stub == NULL) || (timeout <= 0))
+        return (EUCA_ERROR);
+
+    if ((svc_client = axis2_stub_get_svc_client(pStub->stub, pStub->env)) == NULL)
+        return (EUCA_ERROR);
+
+    if ((options = (axis2_options_t *) axis2_svc_client_get_options(svc_client, pStub->env)) == NULL)
+        return (EUCA_ERROR);
+
+    axis2_options_set_timeout_in_milli_seconds(options, pStub->env, ((long)timeout) * 1000L);
+    return (EUCA_OK);
+}
+
 //!
 //! Marshals the Run instance request
 //!
@@ -324,7 +368,7 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
     // set standard input fields
     adb_ncRunInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncRunInstanceType, request, pMeta);
         EUCA_FREE(pMeta->correlationId);
     }
@@ -415,7 +459,7 @@ int ncGetConsoleOutputStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId,
     /* set input fields */
     adb_ncGetConsoleOutputType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncGetConsoleOutputType, request, pMeta);
     }
@@ -472,7 +516,7 @@ int ncRebootInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId)
     /* set input fields */
     adb_ncRebootInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncRebootInstanceType, request, pMeta);
     }
@@ -529,7 +573,7 @@ int ncTerminateInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId
     /* set input fields */
     adb_ncTerminateInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncTerminateInstanceType, request, pMeta);
     }
@@ -596,7 +640,7 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     /* set input fields */
     adb_ncDescribeInstancesType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncDescribeInstancesType, request, pMeta);
     }
@@ -635,6 +679,102 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return (status);
 }
 
+//!
+//! Marshals the client describe instance request, asking only for the instances
+//! that changed since a given generation of the NC's instance list.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration the generation returned by a previous call, or 0 for all instances
+//! @param[out] outInsts a pointer the list of instances that changed since sinceGeneration
+//! @param[out] outInstsLen the number of instances in the outInsts list.
+//! @param[out] unchangedIds a pointer the list of identifiers of instances that did not change
+//! @param[out] unchangedIdsLen the number of identifiers in the unchangedIds list
+//! @param[out] generation the current generation of the NC's instance list (0 if the NC does not support deltas)
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+//! @note NCs without delta support ignore sinceGeneration and return all instances with
+//!       a zero generation, so outInsts and unchangedIds together are always the complete list.
+//!
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***unchangedIds,
+                                 int *unchangedIdsLen, long long *generation)
+{
+    int i = 0;
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    adb_instanceType_t *instance = NULL;
+    adb_ncDescribeInstances_t *input = NULL;
+    adb_ncDescribeInstancesType_t *request = NULL;
+    adb_ncDescribeInstancesResponse_t *output = NULL;
+    adb_ncDescribeInstancesResponseType_t *response = NULL;
+    char *correlation_id = NULL;
+
+    *outInstsLen = 0;
+    *unchangedIdsLen = 0;
+    *generation = 0;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncDescribeInstances_create(env);
+    request = adb_ncDescribeInstancesType_create(env);
+
+    /* set input fields */
+    adb_ncDescribeInstancesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncDescribeInstancesType, request, pMeta);
+    }
+    if (correlation_id != NULL)
+        adb_ncDescribeInstancesType_set_correlationId(request, env, correlation_id);
+
+    if (sinceGeneration > 0)
+        adb_ncDescribeInstancesType_set_sinceGeneration(request, env, sinceGeneration);
+    adb_ncDescribeInstances_set_ncDescribeInstances(input, env, request);
+
+    if ((output = axis2_stub_op_EucalyptusNC_ncDescribeInstances(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncDescribeInstancesResponse_get_ncDescribeInstancesResponse(output, env);
+        if (adb_ncDescribeInstancesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+
+        if ((*outInstsLen = adb_ncDescribeInstancesResponseType_sizeof_instances(response, env)) != 0) {
+            if ((*outInsts = EUCA_ZALLOC(*outInstsLen, sizeof(ncInstance *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *outInstsLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *outInstsLen; i++) {
+                    instance = adb_ncDescribeInstancesResponseType_get_instances_at(response, env, i);
+                    (*outInsts)[i] = copy_instance_from_adb(instance, env);
+                }
+            }
+        }
+
+        if ((*unchangedIdsLen = adb_ncDescribeInstancesResponseType_sizeof_unchangedInstanceIds(response, env)) != 0) {
+            if ((*unchangedIds = EUCA_ZALLOC(*unchangedIdsLen, sizeof(char *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *unchangedIdsLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *unchangedIdsLen; i++) {
+                    (*unchangedIds)[i] = strdup(adb_ncDescribeInstancesResponseType_get_unchangedInstanceIds_at(response, env, i));
+                }
+            }
+        }
+
+        *generation = adb_ncDescribeInstancesResponseType_get_generation(response, env);
+    }
+
+    return (status);
+}
+
 //!
 //! Handle the client describe resource request
 //!
@@ -665,7 +805,7 @@ int ncDescribeResourceStub(ncStub * pStub, ncMetadata * pMeta, char *resourceTyp
     /* set input fields */
     adb_ncDescribeResourceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncDescribeResourceType, request, pMeta);
     }
@@ -737,7 +877,7 @@ int ncBroadcastNetworkInfoStub(ncStub * pStub, ncMetadata * pMeta, char *network
     // set standard input fields
     adb_ncBroadcastNetworkInfoType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncBroadcastNetworkInfoType, request, pMeta);
     }
@@ -793,7 +933,7 @@ int ncAssignAddressStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, ch
     // set standard input fields
     adb_ncAssignAddressType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncAssignAddressType, request, pMeta);
     }
@@ -848,7 +988,7 @@ int ncPowerDownStub(ncStub * pStub, ncMetadata * pMeta)
     // set standard input fields
     adb_ncPowerDownType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncPowerDownType, request, pMeta);
     }
@@ -906,7 +1046,7 @@ int ncStartNetworkStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char **pe
     // set standard input fields
     adb_ncStartNetworkType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncStartNetworkType, request, pMeta);
     }
@@ -972,7 +1112,7 @@ int ncAttachVolumeStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, cha
     // set standard input fields
     adb_ncAttachVolumeType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncAttachVolumeType, request, pMeta);
     }
@@ -1033,7 +1173,7 @@ int ncDetachVolumeStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, cha
     // set standard input fields
     adb_ncDetachVolumeType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncDetachVolumeType, request, pMeta);
     }
@@ -1105,7 +1245,7 @@ int ncBundleInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, c
     // set standard input fields
     adb_ncBundleInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncBundleInstanceType, request, pMeta);
     }
@@ -1166,7 +1306,7 @@ int ncBundleRestartInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instan
     // set standard input fields
     adb_ncBundleRestartInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncBundleRestartInstanceType, request, pMeta);
     }
@@ -1220,7 +1360,7 @@ int ncCancelBundleTaskStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId)
     // set standard input fields
     adb_ncCancelBundleTaskType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncCancelBundleTaskType, request, pMeta);
     }
@@ -1278,7 +1418,7 @@ int ncDescribeBundleTasksStub(ncStub * pStub, ncMetadata * pMeta, char **instIds
 
     // set standard input fields
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         if (correlation_id != NULL)
             adb_ncDescribeBundleTasksType_set_correlationId(request, env, correlation_id);
         adb_ncDescribeBundleTasksType_set_userId(request, env, pMeta->userId);
@@ -1344,7 +1484,7 @@ int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char
     // set standard input fields
     adb_ncCreateImageType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncCreateImageType, request, pMeta);
     }
@@ -1410,7 +1550,7 @@ int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, l
     // set standard input fields
     adb_ncDescribeSensorsType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncDescribeSensorsType, request, pMeta);
     }
@@ -1460,6 +1600,95 @@ int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, l
     return (status);
 }
 
+//!
+//! Marshals the client batched describe sensor request, in which the NC only sends the
+//! sensor values past the cursors, in the compact encoding of sensor_encode_batch(). An NC
+//! that does not know of cursors ignores them and replies with all of its sensor resources,
+//! which are then returned the same way.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  historySize the size of the data history to retrieve
+//! @param[in]  collectionIntervalTimeMs the data collection interval in milliseconds
+//! @param[in]  cursors the cursors from sensor_get_cursors()
+//! @param[out] outResources a list of sensor resources created by this request
+//! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
+//!
+//! @return 0 for success, non-zero for error
+//!
+//! @see ncDescribeSensorsStub(), sensor_decode_batch()
+//!
+int ncDescribeSensorsBatchedStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char *cursors,
+                                 sensorResource *** outResources, int *outResourcesLen)
+{
+    int i = 0;
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    adb_ncDescribeSensors_t *input = NULL;
+    adb_ncDescribeSensorsType_t *request = NULL;
+    adb_ncDescribeSensorsResponse_t *output = NULL;
+    adb_ncDescribeSensorsResponseType_t *response = NULL;
+    adb_sensorsResourceType_t *resource = NULL;
+    axis2_char_t *batch = NULL;
+    char *correlation_id = NULL;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncDescribeSensors_create(env);
+    request = adb_ncDescribeSensorsType_create(env);
+
+    // set standard input fields
+    adb_ncDescribeSensorsType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncDescribeSensorsType, request, pMeta);
+    }
+
+    if (correlation_id != NULL)
+        adb_ncDescribeSensorsType_set_correlationId(request, env, correlation_id);
+
+    // set custom input fields
+    adb_ncDescribeSensorsType_set_historySize(request, env, historySize);
+    adb_ncDescribeSensorsType_set_collectionIntervalTimeMs(request, env, collectionIntervalTimeMs);
+    adb_ncDescribeSensorsType_set_sensorCursors(request, env, cursors);
+    adb_ncDescribeSensors_set_ncDescribeSensors(input, env, request);
+
+    *outResources = NULL;
+    *outResourcesLen = 0;
+
+    // do it
+    if ((output = axis2_stub_op_EucalyptusNC_ncDescribeSensors(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncDescribeSensorsResponse_get_ncDescribeSensorsResponse(output, env);
+        if (adb_ncDescribeSensorsResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+
+        if ((batch = adb_ncDescribeSensorsResponseType_get_sensorBatch(response, env)) != NULL) {
+            if (sensor_decode_batch(batch, outResources, outResourcesLen) != EUCA_OK)
+                status = 2;
+        } else if ((*outResourcesLen = adb_ncDescribeSensorsResponseType_sizeof_sensorsResources(response, env)) > 0) {
+            if ((*outResources = EUCA_ZALLOC(*outResourcesLen, sizeof(sensorResource *))) == NULL) {
+                LOGERROR("out of memory\n");
+                *outResourcesLen = 0;
+                status = 2;
+            } else {
+                for (i = 0; i < *outResourcesLen; i++) {
+                    resource = adb_ncDescribeSensorsResponseType_get_sensorsResources_at(response, env, i);
+                    (*outResources)[i] = copy_sensor_resource_from_adb(resource, env);
+                }
+            }
+        }
+    }
+
+    return (status);
+}
+
 //!
 //! Marshals the node controller modification request.
 //!
@@ -1490,7 +1719,7 @@ int ncModifyNodeStub(ncStub * pStub, ncMetadata * pMeta, char *stateName)
     // set standard input fields
     adb_ncModifyNodeType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncModifyNodeType, request, pMeta);
     }
@@ -1550,7 +1779,7 @@ int ncMigrateInstancesStub(ncStub * pStub, ncMetadata * pMeta, ncInstance ** ins
     // set standard input fields
     adb_ncMigrateInstancesType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncMigrateInstancesType, request, pMeta);
     }
@@ -1619,7 +1848,7 @@ int ncStartInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId)
     // set standard input fields
     adb_ncStartInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncStartInstanceType, request, pMeta);
     }
@@ -1678,7 +1907,7 @@ int ncStopInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId)
     // set standard input fields
     adb_ncStopInstanceType_set_nodeName(request, env, pStub->node_name);
     if (pMeta) {
-        correlation_id = create_corrid(pMeta->correlationId);
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
         EUCA_FREE(pMeta->correlationId);
         EUCA_MESSAGE_MARSHAL(ncStopInstanceType, request, pMeta);
     }
@@ -1707,6 +1936,160 @@ int ncStopInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId)
     return (status);
 }
 
+//!
+//! Marshals the request to terminate a list of instances in one call.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to terminate
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[in]  force if set to 1 will force the termination of the instances
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, set to 0 for the instances whose
+//!             termination was queued and to 1 for those that the NC failed to terminate
+//!
+//! @return 0 for success, -1 if the call failed (as it does with an NC that predates the
+//!         operation) and 1 if the NC returned an error
+//!
+//! @see ncTerminateInstances()
+//!
+int ncTerminateInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int *outStatus)
+{
+    int i = 0;
+    int j = 0;
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    axis2_char_t *failedId = NULL;
+    adb_ncTerminateInstances_t *input = NULL;
+    adb_ncTerminateInstancesType_t *request = NULL;
+    adb_ncTerminateInstancesResponse_t *output = NULL;
+    adb_ncTerminateInstancesResponseType_t *response = NULL;
+    char *correlation_id = NULL;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncTerminateInstances_create(env);
+    request = adb_ncTerminateInstancesType_create(env);
+
+    // set standard input fields
+    adb_ncTerminateInstancesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncTerminateInstancesType, request, pMeta);
+    }
+
+    if (correlation_id != NULL)
+        adb_ncTerminateInstancesType_set_correlationId(request, env, correlation_id);
+
+    // set op-specific input fields
+    for (i = 0; i < instIdsLen; i++) {
+        adb_ncTerminateInstancesType_add_instanceIds(request, env, instIds[i]);
+        if (outStatus)
+            outStatus[i] = 0;
+    }
+    adb_ncTerminateInstancesType_set_force(request, env, (force ? AXIS2_TRUE : AXIS2_FALSE));
+    adb_ncTerminateInstances_set_ncTerminateInstances(input, env, request);
+
+    // do it
+    if ((output = axis2_stub_op_EucalyptusNC_ncTerminateInstances(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncTerminateInstancesResponse_get_ncTerminateInstancesResponse(output, env);
+        if (adb_ncTerminateInstancesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+        // extract the fields from reponse
+        for (j = 0; j < adb_ncTerminateInstancesResponseType_sizeof_failedInstanceIds(response, env); j++) {
+            failedId = adb_ncTerminateInstancesResponseType_get_failedInstanceIds_at(response, env, j);
+            for (i = 0; (outStatus != NULL) && (failedId != NULL) && (i < instIdsLen); i++) {
+                if (!strcmp(instIds[i], failedId))
+                    outStatus[i] = 1;
+            }
+        }
+    }
+
+    return (status);
+}
+
+//!
+//! Marshals the request to reboot a list of instances in one call.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to reboot
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, set to 0 for the instances that
+//!             are rebooting and to 1 for those that the NC failed to reboot
+//!
+//! @return 0 for success, -1 if the call failed (as it does with an NC that predates the
+//!         operation) and 1 if the NC returned an error
+//!
+//! @see ncRebootInstances()
+//!
+int ncRebootInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int *outStatus)
+{
+    int i = 0;
+    int j = 0;
+    int status = 0;
+    axutil_env_t *env = NULL;
+    axis2_stub_t *stub = NULL;
+    axis2_char_t *failedId = NULL;
+    adb_ncRebootInstances_t *input = NULL;
+    adb_ncRebootInstancesType_t *request = NULL;
+    adb_ncRebootInstancesResponse_t *output = NULL;
+    adb_ncRebootInstancesResponseType_t *response = NULL;
+    char *correlation_id = NULL;
+
+    env = pStub->env;
+    stub = pStub->stub;
+    input = adb_ncRebootInstances_create(env);
+    request = adb_ncRebootInstancesType_create(env);
+
+    // set standard input fields
+    adb_ncRebootInstancesType_set_nodeName(request, env, pStub->node_name);
+    if (pMeta) {
+        correlation_id = trace_outgoing_corrid(pMeta->correlationId);
+        EUCA_FREE(pMeta->correlationId);
+        EUCA_MESSAGE_MARSHAL(ncRebootInstancesType, request, pMeta);
+    }
+
+    if (correlation_id != NULL)
+        adb_ncRebootInstancesType_set_correlationId(request, env, correlation_id);
+
+    // set op-specific input fields
+    for (i = 0; i < instIdsLen; i++) {
+        adb_ncRebootInstancesType_add_instanceIds(request, env, instIds[i]);
+        if (outStatus)
+            outStatus[i] = 0;
+    }
+    adb_ncRebootInstances_set_ncRebootInstances(input, env, request);
+
+    // do it
+    if ((output = axis2_stub_op_EucalyptusNC_ncRebootInstances(stub, env, input)) == NULL) {
+        LOGERROR(NULL_ERROR_MSG);
+        status = -1;
+    } else {
+        response = adb_ncRebootInstancesResponse_get_ncRebootInstancesResponse(output, env);
+        if (adb_ncRebootInstancesResponseType_get_return(response, env) == AXIS2_FALSE) {
+            LOGERROR("returned an error\n");
+            status = 1;
+        }
+        // extract the fields from reponse
+        for (j = 0; j < adb_ncRebootInstancesResponseType_sizeof_failedInstanceIds(response, env); j++) {
+            failedId = adb_ncRebootInstancesResponseType_get_failedInstanceIds_at(response, env, j);
+            for (i = 0; (outStatus != NULL) && (failedId != NULL) && (i < instIdsLen); i++) {
+                if (!strcmp(instIds[i], failedId))
+                    outStatus[i] = 1;
+            }
+        }
+    }
+
+    return (status);
+}
+
 /*************************
  a template for future ops
  *************************
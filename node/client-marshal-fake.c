@@ -83,12 +83,15 @@
 #include <sys/mman.h>
 #include <sys/stat.h>                  /* For mode constants */
 #include <fcntl.h>                     /* For O_* constants */
+#include <unistd.h>
+#include <time.h>
 
 #include <eucalyptus.h>
 #define HANDLERS_FANOUT
 #include "handlers.h"
 #include "client-marshal.h"
 #include <euca_auth.h>
+#include <misc.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -97,6 +100,8 @@
 \*----------------------------------------------------------------------------*/
 
 #define MAX_FAKE_INSTANCES                      4096    //!< Maximum number of fake instances
+#define MAX_FAKE_NODES                          MAXNODES    //!< Maximum number of simulated nodes
+#define FAKE_SETTINGS_REFRESH_SECONDS           10      //!< How often the simulation settings are re-read from eucalyptus.conf
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -104,6 +109,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+typedef struct fakenode_t fakenode;
 typedef struct fakeconfig_t fakeconfig;
 
 /*----------------------------------------------------------------------------*\
@@ -123,10 +129,18 @@ enum {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+ //! Simulated node, one per distinct node name the CC talks to
+struct fakenode_t {
+    char name[HOSTNAME_SIZE];          //!< node name, as extracted from the endpoint URI
+    ncResource res;                    //!< NC component resources of this node
+};
+
  //! Fake Client Configuration Structure
 struct fakeconfig_t {
     ncInstance global_instances[MAX_FAKE_INSTANCES];    //!< list of instances
-    ncResource res;                    //!< NC component resources
+    int instance_nodes[MAX_FAKE_INSTANCES]; //!< 1 + index in nodes[] of the node running each instance, 0 if none
+    fakenode nodes[MAX_FAKE_NODES];    //!< simulated nodes
+    int numNodes;                      //!< number of entries used in nodes[]
     time_t current;
     time_t last;
 };
@@ -154,12 +168,26 @@ sem_t *fakelock = NULL;                //!< fake configuration lock
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! @{
+//! @name Simulation settings, read from eucalyptus.conf by fake_load_settings()
+static int fake_latency_ms = 0;        //!< FAKE_NC_LATENCY_MS: mean time spent in each call, actual delays vary between 0.5x and 1.5x
+static int fake_failure_rate = 0;      //!< FAKE_NC_FAILURE_RATE: percentage of calls that fail without touching any state
+static int fake_instances = 0;         //!< FAKE_NC_INSTANCES: number of running instances every node starts with
+static time_t fake_settings_time = 0;  //!< when the settings were last read
+static pid_t fake_seeded_pid = 0;      //!< process for which rand() was last seeded
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void fake_load_settings(void);
+static int fake_call(ncStub * pStub, const char *opName);
+static int fake_node_index(ncStub * pStub);
+static void fake_terminate_instance(const char *instanceId, boolean release_address);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -325,9 +353,12 @@ void loadNcStuff()
     int done = 0;
     int rc = 0;
 
-    rc = setup_shared_buffer_fake((void **)&myconfig, "/eucalyptusCCfakeconfig", sizeof(fakeconfig), &fakelock, "/eucalyptusCCfakelock", SHARED_FILE);
-    if (rc) {
-        LOGDEBUG("fakeNC:  error setting up shared mem\n");
+    // the mapping and the lock survive fork(), so they only need to be set up once per process tree
+    if ((myconfig == NULL) || (fakelock == NULL)) {
+        rc = setup_shared_buffer_fake((void **)&myconfig, "/eucalyptusCCfakeconfig", sizeof(fakeconfig), &fakelock, "/eucalyptusCCfakelock", SHARED_FILE);
+        if (rc) {
+            LOGDEBUG("fakeNC:  error setting up shared mem\n");
+        }
     }
     sem_wait(fakelock);
 
@@ -356,6 +387,7 @@ void loadNcStuff()
                 if (!strcmp(myconfig->global_instances[i].stateName, "Teardown") && ((time(NULL) - myconfig->global_instances[i].launchTime) > 300)) {
                     LOGDEBUG("fakeNC: setup(): invalidating instance %s\n", myconfig->global_instances[i].instanceId);
                     bzero(&(myconfig->global_instances[i]), sizeof(ncInstance));
+                    myconfig->instance_nodes[i] = 0;
                 } else {
                     for (j = 0; j < EUCA_MAX_VOLUMES; j++) {
                         if (strlen(myconfig->global_instances[i].volumes[j].volumeId)
@@ -370,6 +402,152 @@ void loadNcStuff()
     }
 }
 
+//!
+//! Reads the simulation settings from eucalyptus.conf, at most once every
+//! FAKE_SETTINGS_REFRESH_SECONDS so they can be changed while the CC runs
+//!
+static void fake_load_settings(void)
+{
+    char *home = NULL;
+    char *value = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    time_t now = time(NULL);
+
+    if ((now - fake_settings_time) < FAKE_SETTINGS_REFRESH_SECONDS)
+        return;
+    fake_settings_time = now;
+
+    if ((home = getenv(EUCALYPTUS_ENV_VAR_NAME)) == NULL)
+        home = "";
+    snprintf(path, EUCA_MAX_PATH, EUCALYPTUS_CONF_LOCATION, home);
+
+    fake_latency_ms = fake_failure_rate = fake_instances = 0;
+    if (get_conf_var(path, "FAKE_NC_LATENCY_MS", &value) == 1) {
+        fake_latency_ms = MAX(0, atoi(value));
+        EUCA_FREE(value);
+    }
+    if (get_conf_var(path, "FAKE_NC_FAILURE_RATE", &value) == 1) {
+        fake_failure_rate = MIN(100, MAX(0, atoi(value)));
+        EUCA_FREE(value);
+    }
+    if (get_conf_var(path, "FAKE_NC_INSTANCES", &value) == 1) {
+        fake_instances = MAX(0, atoi(value));
+        EUCA_FREE(value);
+    }
+}
+
+//!
+//! Simulates the cost and the unreliability of a call to a real NC: waits for the
+//! configured latency and then decides whether the call fails. This is done before
+//! taking the fake configuration lock so that slow nodes do not serialize the others.
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//! @param[in] opName the name of the simulated operation, for the logs
+//!
+//! @return EUCA_OK if the call should proceed or EUCA_ERROR if it should fail
+//!
+static int fake_call(ncStub * pStub, const char *opName)
+{
+    long long delay_ms = 0;
+    struct timespec ts = { 0 };
+
+    fake_load_settings();
+
+    if (fake_seeded_pid != getpid()) {
+        fake_seeded_pid = getpid();
+        srand(time(NULL) ^ (fake_seeded_pid << 16));
+    }
+
+    if (fake_latency_ms > 0) {
+        delay_ms = fake_latency_ms / 2 + (rand() % (fake_latency_ms + 1));
+        ts.tv_sec = delay_ms / 1000;
+        ts.tv_nsec = (delay_ms % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+    }
+
+    if ((fake_failure_rate > 0) && ((rand() % 100) < fake_failure_rate)) {
+        LOGDEBUG("fakeNC: %s(): simulating a failure of node %s\n", opName, ((pStub && pStub->node_name) ? pStub->node_name : "UNSET"));
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the simulated node a stub talks to, adding it on first contact with its
+//! resources and FAKE_NC_INSTANCES running instances. Must be called with the fake
+//! configuration lock held, i.e. between loadNcStuff() and saveNcStuff().
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//!
+//! @return the index of the node in myconfig->nodes[] or -1 if there is no room for it
+//!
+static int fake_node_index(ncStub * pStub)
+{
+    int i = 0;
+    int j = 0;
+    int idx = -1;
+    char *name = ((pStub && pStub->node_name) ? pStub->node_name : "localhost");
+    char instanceId[CHAR_BUFFER_SIZE] = "";
+    char uuid[CHAR_BUFFER_SIZE] = "";
+    fakenode *node = NULL;
+    ncResource *res = NULL;
+    ncInstance *instance = NULL;
+    netConfig netparams = { 0 };
+    virtualMachine params = { 0 };
+
+    for (i = 0; i < myconfig->numNodes; i++) {
+        if (!strcmp(myconfig->nodes[i].name, name))
+            return (i);
+    }
+
+    if (myconfig->numNodes >= MAX_FAKE_NODES) {
+        LOGERROR("fakeNC: cannot simulate more than %d nodes, ignoring %s\n", MAX_FAKE_NODES, name);
+        return (-1);
+    }
+
+    idx = myconfig->numNodes++;
+    node = &(myconfig->nodes[idx]);
+    euca_strncpy(node->name, name, HOSTNAME_SIZE);
+    if ((res = allocate_resource("OK", 0, "iqn.1993-08.org.debian:01:736a4e92c588", 1024000, 1024000, 30000000, 30000000, 4096, 4096, "none", "kvm")) != NULL) {
+        memcpy(&(node->res), res, sizeof(ncResource));
+        EUCA_FREE(res);
+    }
+
+    params.mem = 512;
+    params.cores = 1;
+    params.disk = 5;
+    euca_strncpy(params.name, "m1.small", sizeof(params.name));
+    for (i = 0, j = 0; (i < fake_instances) && (j < MAX_FAKE_INSTANCES); i++) {
+        while ((j < MAX_FAKE_INSTANCES) && strlen(myconfig->global_instances[j].instanceId))
+            j++;
+        if (j == MAX_FAKE_INSTANCES) {
+            LOGWARN("fakeNC: only %d of %d instances preloaded on node %s, the fake configuration is full\n", i, fake_instances, name);
+            break;
+        }
+
+        snprintf(instanceId, sizeof(instanceId), "i-%04x%04x", (idx & 0xFFFF), (i & 0xFFFF));
+        snprintf(uuid, sizeof(uuid), "fake-%s", instanceId);
+        snprintf(netparams.privateIp, IP_BUFFER_SIZE, "10.%d.%d.%d", ((idx >> 8) & 0xFF), (idx & 0xFF), ((i % 254) + 1));
+        snprintf(netparams.publicIp, IP_BUFFER_SIZE, "0.0.0.0");
+        snprintf(netparams.privateMac, MAC_BUFFER_SIZE, "d0:0d:%02x:%02x:%02x:%02x", ((idx >> 8) & 0xFF), (idx & 0xFF), ((i >> 8) & 0xFF), (i & 0xFF));
+        instance = allocate_instance(uuid, instanceId, "r-fake", &params, instance_state_names[EXTANT], EXTANT, "fake", "fake", "fake",
+                                     &netparams, "", "", "0", "linux", 0, NULL, 0);
+        if (instance == NULL)
+            break;
+
+        instance->launchTime = time(NULL);
+        memcpy(&(myconfig->global_instances[j]), instance, sizeof(ncInstance));
+        myconfig->instance_nodes[j] = idx + 1;
+        node->res.memorySizeAvailable -= params.mem;
+        node->res.numberOfCoresAvailable -= params.cores;
+        node->res.diskSizeAvailable -= params.disk;
+        free_instance(&instance);
+    }
+
+    LOGDEBUG("fakeNC: simulating node %s at idx %d with %d instances\n", name, idx, i);
+    return (idx);
+}
+
 //!
 //! Creates and initialize an NC stub entry
 //!
@@ -472,6 +650,19 @@ int ncStubDestroy(ncStub * pStub)
     return (EUCA_OK);
 }
 
+//!
+//! Sets the call timeout of an NC stub (nothing to do here)
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//! @param[in] timeout the timeout in seconds
+//!
+//! @return Always returns EUCA_OK
+//!
+int ncStubSetTimeout(ncStub * pStub, int timeout)
+{
+    return (EUCA_OK);
+}
+
 //! Handles the client broadcast network info rquest
 //!
 //! @param[in] pStub a pointer to the node controller (NC) stub structure
@@ -490,6 +681,9 @@ int ncBroadcastNetworkInfoStub(ncStub * pStub, ncMetadata * pMeta, char *network
         return (EUCA_INVALID_ERROR);
     }
 
+    if (fake_call(pStub, "broadcastNetworkInfo") != EUCA_OK)
+        return (EUCA_ERROR);
+
     LOGTRACE("encoded networkInfo=%s\n", networkInfo);
     snprintf(xmlpath, EUCA_MAX_PATH, "/tmp/global_network_info.xml");
     LOGDEBUG("decoding/writing buffer to (%s)\n", xmlpath);
@@ -544,6 +738,7 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
                       int groupNamesSize, char *rootDirective, ncInstance ** outInstPtr)
 {
     int i = 0;
+    int idx = -1;
     int foundidx = -1;
     ncInstance *instance = NULL;
 
@@ -555,24 +750,33 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
         return (EUCA_ERROR);
     }
 
+    if (fake_call(pStub, "runInstance") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
 
+    for (i = 0; i < MAX_FAKE_INSTANCES && (foundidx < 0); i++) {
+        if (!strlen(myconfig->global_instances[i].instanceId)) {
+            foundidx = i;
+        }
+    }
+
+    if (((idx = fake_node_index(pStub)) < 0) || (foundidx < 0)) {
+        LOGERROR("fakeNC: runInstance(): no room left for instance %s\n", instanceId);
+        saveNcStuff();
+        return (EUCA_ERROR);
+    }
+
     instance = allocate_instance(uuid, instanceId, reservationId, params, instance_state_names[PENDING], PENDING, pMeta->userId, ownerId, accountId,
-                                 netparams, keyName, userData, launchIndex, platform, expiryTime, groupNames, groupNamesSize, rootDirective);
+                                 netparams, keyName, userData, launchIndex, platform, expiryTime, groupNames, groupNamesSize);
     if (instance) {
         instance->launchTime = time(NULL);
-        foundidx = -1;
-        for (i = 0; i < MAX_FAKE_INSTANCES && (foundidx < 0); i++) {
-            if (!strlen(myconfig->global_instances[i].instanceId)) {
-                foundidx = i;
-            }
-        }
-
         memcpy(&(myconfig->global_instances[foundidx]), instance, sizeof(ncInstance));
-        LOGDEBUG("fakeNC: runInstance(): decrementing resource by %d/%d/%d\n", params->cores, params->mem, params->disk);
-        myconfig->res.memorySizeAvailable -= params->mem;
-        myconfig->res.numberOfCoresAvailable -= params->cores;
-        myconfig->res.diskSizeAvailable -= params->disk;
+        myconfig->instance_nodes[foundidx] = idx + 1;
+        LOGDEBUG("fakeNC: runInstance(): decrementing resource of %s by %d/%d/%d\n", myconfig->nodes[idx].name, params->cores, params->mem, params->disk);
+        myconfig->nodes[idx].res.memorySizeAvailable -= params->mem;
+        myconfig->nodes[idx].res.numberOfCoresAvailable -= params->cores;
+        myconfig->nodes[idx].res.diskSizeAvailable -= params->disk;
 
         *outInstPtr = instance;
         LOGDEBUG("fakeNC: runInstance(): allocated and stored instance\n");
@@ -581,7 +785,7 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
     }
 
     saveNcStuff();
-    return (EUCA_OK);
+    return ((instance != NULL) ? EUCA_OK : EUCA_ERROR);
 }
 
 //!
@@ -598,9 +802,6 @@ int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *inst
 //!
 int ncTerminateInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, int force, int *shutdownState, int *previousState)
 {
-    int i = 0;
-    int done = 0;
-
     LOGDEBUG("fakeNC: terminateInstance(): params: instanceId=%s force=%d\n", SP(instanceId), force);
 
     if (!instanceId) {
@@ -608,25 +809,81 @@ int ncTerminateInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId
         return (EUCA_ERROR);
     }
 
+    if (fake_call(pStub, "terminateInstance") != EUCA_OK)
+        return (EUCA_ERROR);
+
+    loadNcStuff();
+    fake_terminate_instance(instanceId, FALSE);
+
+    if (shutdownState && previousState) {
+        *shutdownState = *previousState = 0;
+    }
+
+    saveNcStuff();
+    return (EUCA_OK);
+}
+
+//!
+//! Handles the request to terminate a list of instances, as one call to the fake NC, which
+//! also releases their public addresses
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to terminate
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[in]  force if set to 1 will force the termination of the instances
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, all set to 0 on success
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int ncTerminateInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int *outStatus)
+{
+    int i = 0;
+
+    LOGDEBUG("fakeNC: terminateInstances(): params: instIdsLen=%d force=%d\n", instIdsLen, force);
+
+    if (fake_call(pStub, "terminateInstances") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
+    for (i = 0; i < instIdsLen; i++) {
+        if (instIds[i])
+            fake_terminate_instance(instIds[i], TRUE);
+        if (outStatus)
+            outStatus[i] = 0;
+    }
+    saveNcStuff();
+    return (EUCA_OK);
+}
+
+//!
+//! Puts a fake instance in Teardown, giving its resources back to its node. The caller
+//! holds the fake configuration lock.
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//! @param[in] release_address set to TRUE to also clear its public IP
+//!
+static void fake_terminate_instance(const char *instanceId, boolean release_address)
+{
+    int i = 0;
+    int done = 0;
+    ncResource *res = NULL;
 
     for (i = 0; i < MAX_FAKE_INSTANCES && !done; i++) {
         if (!strcmp(myconfig->global_instances[i].instanceId, instanceId)) {
             LOGDEBUG("fakeNC: terminateInstance():\tsetting stateName for instance %s at idx %d\n", instanceId, i);
+            if (strcmp(myconfig->global_instances[i].stateName, "Teardown") && (myconfig->instance_nodes[i] > 0)) {
+                res = &(myconfig->nodes[myconfig->instance_nodes[i] - 1].res);
+                res->memorySizeAvailable += myconfig->global_instances[i].params.mem;
+                res->numberOfCoresAvailable += myconfig->global_instances[i].params.cores;
+                res->diskSizeAvailable += myconfig->global_instances[i].params.disk;
+            }
             snprintf(myconfig->global_instances[i].stateName, 10, "Teardown");
-            myconfig->res.memorySizeAvailable += myconfig->global_instances[i].params.mem;
-            myconfig->res.numberOfCoresAvailable += myconfig->global_instances[i].params.cores;
-            myconfig->res.diskSizeAvailable += myconfig->global_instances[i].params.disk;
+            if (release_address)
+                snprintf(myconfig->global_instances[i].ncnet.publicIp, IP_BUFFER_SIZE, "%s", "0.0.0.0");
             done++;
         }
     }
-
-    if (shutdownState && previousState) {
-        *shutdownState = *previousState = 0;
-    }
-
-    saveNcStuff();
-    return (EUCA_OK);
 }
 
 //!
@@ -650,6 +907,9 @@ int ncAssignAddressStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, ch
         return (EUCA_ERROR);
     }
 
+    if (fake_call(pStub, "assignAddress") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
 
     for (i = 0; i < MAX_FAKE_INSTANCES && !done; i++) {
@@ -692,22 +952,33 @@ int ncPowerDownStub(ncStub * pStub, ncMetadata * pMeta)
 int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen)
 {
     int i = 0;
+    int idx = -1;
     int numinsts = 0;
     ncInstance *newinst = NULL;
 
     LOGDEBUG("fakeNC: describeInstances(): params: instIdsLen=%d\n", instIdsLen);
 
+    *outInsts = NULL;
+    *outInstsLen = 0;
     if (instIdsLen < 0) {
         LOGERROR("fakeNC: describeInstances(): bad input params\n");
         return (EUCA_ERROR);
     }
 
+    if (fake_call(pStub, "describeInstances") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
 
+    if ((idx = fake_node_index(pStub)) < 0) {
+        saveNcStuff();
+        return (EUCA_ERROR);
+    }
+
     //  *outInstsLen = myconfig->instanceidx+1;
     *outInsts = EUCA_ZALLOC(MAX_FAKE_INSTANCES, sizeof(ncInstance *));
     for (i = 0; i < MAX_FAKE_INSTANCES; i++) {
-        if (strlen(myconfig->global_instances[i].instanceId)) {
+        if (strlen(myconfig->global_instances[i].instanceId) && (myconfig->instance_nodes[i] == (idx + 1))) {
             newinst = EUCA_ZALLOC(1, sizeof(ncInstance));
             if (!strcmp(myconfig->global_instances[i].stateName, "Pending")) {
                 snprintf(myconfig->global_instances[i].stateName, 8, "Extant");
@@ -731,6 +1002,32 @@ int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds,
     return (EUCA_OK);
 }
 
+//!
+//! Handles the client incremental describe instance request. This implementation
+//! has no notion of instance generations, so it always returns all instances.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration UNUSED
+//! @param[out] outInsts a pointer the list of instances for which we have data
+//! @param[out] outInstsLen the number of instances in the outInsts list.
+//! @param[out] unchangedIds always set to NULL
+//! @param[out] unchangedIdsLen always set to 0
+//! @param[out] generation always set to 0
+//!
+//! @return the result of ncDescribeInstancesStub()
+//!
+//! @see ncDescribeInstancesStub()
+//!
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***unchangedIds,
+                                 int *unchangedIdsLen, long long *generation)
+{
+    *unchangedIds = NULL;
+    *unchangedIdsLen = 0;
+    *generation = 0;
+    return (ncDescribeInstancesStub(pStub, pMeta, NULL, 0, outInsts, outInstsLen));
+}
+
 //!
 //! Handles the client bundle instance request.
 //!
@@ -810,30 +1107,27 @@ int ncDescribeBundleTasksStub(ncStub * pStub, ncMetadata * pMeta, char **instIds
 //!
 int ncDescribeResourceStub(ncStub * pStub, ncMetadata * pMeta, char *resourceType, ncResource ** outRes)
 {
+    int idx = -1;
     int ret = EUCA_OK;
     ncResource *res = NULL;
 
+    *outRes = NULL;
+    if (fake_call(pStub, "describeResource") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
 
-    if (myconfig->res.memorySizeMax <= 0) {
-        // not initialized?
-        res = allocate_resource("OK", 0, "iqn.1993-08.org.debian:01:736a4e92c588", 1024000, 1024000, 30000000, 30000000, 4096, 4096, "none");
-        if (!res) {
-            LOGERROR("fakeNC: describeResource(): failed to allocate fake resource\n");
-            ret = EUCA_ERROR;
-        } else {
-            memcpy(&(myconfig->res), res, sizeof(ncResource));
-            EUCA_FREE(res);
-        }
+    if (((idx = fake_node_index(pStub)) < 0) || (myconfig->nodes[idx].res.memorySizeMax <= 0)) {
+        LOGERROR("fakeNC: describeResource(): failed to allocate fake resource\n");
+        ret = EUCA_ERROR;
     }
 
     if (!ret) {
-        snprintf(myconfig->res.nodeStatus, 32, "enabled");
-        res = EUCA_ALLOC(1, sizeof(ncResource));
-        memcpy(res, &(myconfig->res), sizeof(ncResource));
+        snprintf(myconfig->nodes[idx].res.nodeStatus, 32, "enabled");
+        if ((res = EUCA_ALLOC(1, sizeof(ncResource))) != NULL) {
+            memcpy(res, &(myconfig->nodes[idx].res), sizeof(ncResource));
+        }
         *outRes = res;
-    } else {
-        *outRes = NULL;
     }
 
     saveNcStuff();
@@ -866,6 +1160,9 @@ int ncAttachVolumeStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, cha
         return (EUCA_ERROR);
     }
 
+    if (fake_call(pStub, "attachVolume") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
 
     for (i = 0; i < MAX_FAKE_INSTANCES && !done; i++) {
@@ -885,8 +1182,7 @@ int ncAttachVolumeStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, cha
                 LOGDEBUG("fakeNC: \tfake attaching volume at idx %d\n", foundidx);
                 snprintf(myconfig->global_instances[i].volumes[foundidx].volumeId, CHAR_BUFFER_SIZE, "%s", volumeId);
                 snprintf(myconfig->global_instances[i].volumes[foundidx].attachmentToken, CHAR_BUFFER_SIZE, "%s", remoteDev);
-                snprintf(myconfig->global_instances[i].volumes[foundidx].localDev, CHAR_BUFFER_SIZE, "%s", localDev);
-                snprintf(myconfig->global_instances[i].volumes[foundidx].localDevReal, CHAR_BUFFER_SIZE, "%s", localDev);
+                snprintf(myconfig->global_instances[i].volumes[foundidx].devName, CHAR_BUFFER_SIZE, "%s", localDev);
                 snprintf(myconfig->global_instances[i].volumes[foundidx].stateName, CHAR_BUFFER_SIZE, "%s", "attached");
             }
             done++;
@@ -924,6 +1220,9 @@ int ncDetachVolumeStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, cha
         return (EUCA_ERROR);
     }
 
+    if (fake_call(pStub, "detachVolume") != EUCA_OK)
+        return (EUCA_ERROR);
+
     loadNcStuff();
 
     for (i = 0; i < MAX_FAKE_INSTANCES && !done; i++) {
@@ -982,9 +1281,33 @@ int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char
 int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen,
                           char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen)
 {
+    *outResources = NULL;
+    *outResourcesLen = 0;
     return (EUCA_OK);
 }
 
+//!
+//! Handles the client batched describe sensor request. This implementation has no use
+//! for cursors, so it always returns the whole history of all resources.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  historySize the size of the data history to retrieve
+//! @param[in]  collectionIntervalTimeMs the data collection interval in milliseconds
+//! @param[in]  cursors UNUSED
+//! @param[out] outResources a list of sensor resources created by this request
+//! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
+//!
+//! @return the result of ncDescribeSensorsStub()
+//!
+//! @see ncDescribeSensorsStub()
+//!
+int ncDescribeSensorsBatchedStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char *cursors,
+                                 sensorResource *** outResources, int *outResourcesLen)
+{
+    return (ncDescribeSensorsStub(pStub, pMeta, historySize, collectionIntervalTimeMs, NULL, 0, NULL, 0, outResources, outResourcesLen));
+}
+
 //!
 //! Handles the node controller modification request.
 //!
@@ -1065,6 +1388,13 @@ int ncRebootInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId)
     return (EUCA_OK);
 }
 
+int ncRebootInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int *outStatus)
+{
+    for (int i = 0; (outStatus != NULL) && (i < instIdsLen); i++)
+        outStatus[i] = 0;
+    return (EUCA_OK);
+}
+
 int ncStartNetworkStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char **peers, int peersLen, int port, int vlan, char **outStatus)
 {
     return (EUCA_OK);
@@ -172,6 +172,19 @@ int ncStubDestroy(ncStub * pStub)
     return (EUCA_OK);
 }
 
+//!
+//! Sets the call timeout of an NC stub (nothing to do here)
+//!
+//! @param[in] pStub a pointer to the node controller (NC) stub structure
+//! @param[in] timeout the timeout in seconds
+//!
+//! @return Always returns EUCA_OK
+//!
+int ncStubSetTimeout(ncStub * pStub, int timeout)
+{
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the Run instance request
 //!
@@ -231,6 +244,43 @@ int ncTerminateInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId
     return doTerminateInstance(pMeta, instanceId, force, shutdownState, previousState);
 }
 
+//!
+//! Handles the request to terminate a list of instances
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to terminate
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[in]  force if set to 1 will force the termination of the instances
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, set to 1 for the instances that failed
+//!
+//! @return the result of doTerminateInstances()
+//!
+//! @see doTerminateInstances()
+//!
+int ncTerminateInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int *outStatus)
+{
+    return doTerminateInstances(pMeta, instIds, instIdsLen, force, outStatus);
+}
+
+//!
+//! Handles the request to reboot a list of instances
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to reboot
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, set to 1 for the instances that failed
+//!
+//! @return the result of doRebootInstances()
+//!
+//! @see doRebootInstances()
+//!
+int ncRebootInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int *outStatus)
+{
+    return doRebootInstances(pMeta, instIds, instIdsLen, outStatus);
+}
+
 //!
 //! Handles the client network broadcast info request.
 //!
@@ -289,7 +339,48 @@ int ncPowerDownStub(ncStub * pStub, ncMetadata * pMeta)
 //!
 int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen)
 {
-    return doDescribeInstances(pMeta, instIds, instIdsLen, outInsts, outInstsLen);
+    int i = 0;
+    int rc = EUCA_OK;
+    ncInstance *copy = NULL;
+
+    if ((rc = doDescribeInstances(pMeta, instIds, instIdsLen, outInsts, outInstsLen)) != EUCA_OK)
+        return (rc);
+
+    // the handler returns shared read-only copies, while callers of the stub own the instances they get
+    for (i = 0; i < (*outInstsLen); i++) {
+        if ((copy = EUCA_ALLOC(1, sizeof(ncInstance))) != NULL)
+            memcpy(copy, (*outInsts)[i], sizeof(ncInstance));
+        release_instance_copy((*outInsts)[i]);
+        if (((*outInsts)[i] = copy) == NULL)
+            rc = EUCA_MEMORY_ERROR;
+    }
+    return (rc);
+}
+
+//!
+//! Handles the client incremental describe instance request. This implementation
+//! has no notion of instance generations, so it always returns all instances.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  sinceGeneration UNUSED
+//! @param[out] outInsts a pointer the list of instances for which we have data
+//! @param[out] outInstsLen the number of instances in the outInsts list.
+//! @param[out] unchangedIds always set to NULL
+//! @param[out] unchangedIdsLen always set to 0
+//! @param[out] generation always set to 0
+//!
+//! @return the result of ncDescribeInstancesStub()
+//!
+//! @see ncDescribeInstancesStub()
+//!
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***unchangedIds,
+                                 int *unchangedIdsLen, long long *generation)
+{
+    *unchangedIds = NULL;
+    *unchangedIdsLen = 0;
+    *generation = 0;
+    return (ncDescribeInstancesStub(pStub, pMeta, NULL, 0, outInsts, outInstsLen));
 }
 
 //!
@@ -457,6 +548,28 @@ int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, l
     return doDescribeSensors(pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, outResources, outResourcesLen);
 }
 
+//!
+//! Handles the client batched describe sensor request. This implementation has no use
+//! for cursors, so it always returns the whole history of all resources.
+//!
+//! @param[in]  pStub a pointer to the node controller (NC) stub structure
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  historySize the size of the data history to retrieve
+//! @param[in]  collectionIntervalTimeMs the data collection interval in milliseconds
+//! @param[in]  cursors UNUSED
+//! @param[out] outResources a list of sensor resources created by this request
+//! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
+//!
+//! @return the result of ncDescribeSensorsStub()
+//!
+//! @see ncDescribeSensorsStub()
+//!
+int ncDescribeSensorsBatchedStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char *cursors,
+                                 sensorResource *** outResources, int *outResourcesLen)
+{
+    return (ncDescribeSensorsStub(pStub, pMeta, historySize, collectionIntervalTimeMs, NULL, 0, NULL, 0, outResources, outResourcesLen));
+}
+
 //!
 //! Handles the node controller modification request.
 //!
@@ -80,6 +80,7 @@
 #include "axis2_stub_EucalyptusNC.h"   /* for axis2_ and axutil_ defs */
 #include "data.h"                      /* for eucalyptus defs */
 #include "sensor.h"                    // sensorResource
+#include "euca_arena.h"                // euca_arena
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -112,6 +113,7 @@ typedef struct ncStub_t {
     axis2_char_t *endpoint_uri;        //!< The AXIS2 endpoint URI string
     axis2_char_t *node_name;           //!< The AXIS2 node name parameter string
     axis2_stub_t *stub;                //!< Pointer to the AXIS2 stub structure
+    euca_arena *arena;                 //!< Arena backing the AXIS2 environment, NULL if it is malloc() based
 } ncStub;
 
 /*----------------------------------------------------------------------------*\
@@ -128,6 +130,7 @@ typedef struct ncStub_t {
 
 ncStub *ncStubCreate(char *endpoint, char *logfile, char *homedir);
 int ncStubDestroy(ncStub * stub);
+int ncStubSetTimeout(ncStub * pStub, int timeout);
 
 int ncRunInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char *instanceId, char *reservationId, virtualMachine * params, char *imageId,
                       char *imageURL, char *kernelId, char *kernelURL, char *ramdiskId, char *ramdiskURL, char *ownerId, char *accountId,
@@ -137,6 +140,8 @@ int ncGetConsoleOutputStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId,
 int ncRebootInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
 int ncTerminateInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, int force, int *shutdownState, int *previousState);
 int ncDescribeInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen);
+int ncDescribeInstancesDeltaStub(ncStub * pStub, ncMetadata * pMeta, long long sinceGeneration, ncInstance *** outInsts, int *outInstsLen, char ***unchangedIds,
+                                 int *unchangedIdsLen, long long *generation);
 int ncDescribeResourceStub(ncStub * pStub, ncMetadata * pMeta, char *resourceType, ncResource ** outRes);
 int ncStartNetworkStub(ncStub * pStub, ncMetadata * pMeta, char *uuid, char **peers, int peersLen, int port, int vlan, char **outStatus);
 int ncBroadcastNetworkInfoStub(ncStub * pStub, ncMetadata * pMeta, char *networkInfo);
@@ -155,10 +160,14 @@ int ncDescribeBundleTasksStub(ncStub * pStub, ncMetadata * pMeta, char **instIds
 int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char *volumeId, char *remoteDev);
 int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen,
                           char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
+int ncDescribeSensorsBatchedStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char *cursors,
+                                 sensorResource *** outResources, int *outResourcesLen);
 int ncModifyNodeStub(ncStub * pStub, ncMetadata * pMeta, char *stateName);
 int ncMigrateInstancesStub(ncStub * pStub, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials);
 int ncStartInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
 int ncStopInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
+int ncTerminateInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int *outStatus);
+int ncRebootInstancesStub(ncStub * pStub, ncMetadata * pMeta, char **instIds, int instIdsLen, int *outStatus);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
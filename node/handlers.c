@@ -87,6 +87,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <stddef.h>                    /* offsetof */
 #include <sys/errno.h>
 #include <sys/stat.h>
 #include <pthread.h>
@@ -100,6 +101,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <dirent.h>
 
 #include <eucalyptus.h>
 #include <eucalyptus-config.h>
@@ -127,7 +129,15 @@
 #include "stats.h"
 #include "message_sensor.h"
 #include "message_stats.h"
+#include "metrics_exporter.h"
+#include "fs_emitter.h"
 #include "service_sensor.h"
+#include "lock_sensor.h"
+#include "alloc_sensor.h"
+#include "command_sensor.h"
+#include "qos_sensor.h"
+#include <trace.h>
+#include <euca_probe.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -136,12 +146,27 @@
 \*----------------------------------------------------------------------------*/
 
 #define MONITORING_PERIOD                           (5) //!< Instance state transition monitoring period in seconds.
+#define MONITORING_RECONCILE_PERIOD                 (60)    //!< With domain events, how often, in seconds, the state of settled instances is still polled
+#define TERMINATION_POLL_PERIOD                     (2) //!< How often, in seconds, the termination thread checks on the domains shutting down
+#define RECLAIMING_PERIOD                           (300)   //!< How often, in seconds, zeroed blocks are punched out of cached images
+#define PRESTAGING_PERIOD                           (60)    //!< How often, in seconds, an idle NC checks whether a popular image needs pre-staging
+#define TIERING_PERIOD                              (60)    //!< How often, in seconds, an idle NC checks whether a hot image belongs in the fast tier of the cache
 #define MAX_CREATE_TRYS                              5
 #define CREATE_TIMEOUT_SEC                           60
 #define LIBVIRT_TIMEOUT_SEC                          5
+#define LIBVIRT_KEEPALIVE_INTERVAL_SEC               5  //!< how often, in seconds, libvirt pings libvirtd over an idle hypervisor connection
+#define LIBVIRT_KEEPALIVE_COUNT                      3  //!< number of unanswered pings after which libvirt closes a hypervisor connection as dead
+#define LIBVIRT_QUERY_CALLERS                        4  //!< number of threads that may query the hypervisor concurrently, on the shared query connection
+#define ADOPTION_WORKERS                             8  //!< number of threads adopting running domains when the NC starts
+#define SHARED_INSTANCE_SLAB_MAX_FREE               16  //!< most freed instance copies kept for the next snapshot
 #define PER_INSTANCE_BUFFER_MB                       20 //!< by default reserve this much extra room (in MB) per instance (for kernel, ramdisk, and metadata overhead)
 #define MAX_SENSOR_RESOURCES                         MAXINSTANCES_PER_NC
 #define SEC_PER_MB                                   ((1024 * 1024) / 512)
+#define DENSITY_BALLOON_STATS_PERIOD                 10 //!< with NC_MEMORY_DENSITY, how often, in seconds, guests update the memory statistics of their balloon
+#define KSM_RUN_PATH                                 "/sys/kernel/mm/ksm/run"
+#define KSM_PAGES_SHARING_PATH                       "/sys/kernel/mm/ksm/pages_sharing"   //!< number of pages KSM saves by merging them with identical ones
+#define CGROUP_MOUNT_PATH                            "/sys/fs/cgroup"   //!< where the unified cgroup hierarchy, or the v1 ones, are mounted
+#define SYS_CLASS_NET_PATH                           "/sys/class/net"
 
 #define MIN_BLOBSTORE_SIZE_MB                        10 //!< even with boot-from-EBS one will need work space for kernel and ramdisk
 #define FS_BUFFER_PERCENT                            0.03   //!< leave 3% extra when deciding on blobstore sizes automatically
@@ -165,6 +190,127 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Counters of one block device, as read from /proc/diskstats
+typedef struct ncDiskStat_t {
+    char name[32];                     //!< device name without the /dev/ prefix, e.g. "sdb" or "dm-3"
+    unsigned int major;                //!< major device number
+    unsigned int minor;                //!< minor device number
+    unsigned long long reads_comp;     //!< reads completed successfully
+    unsigned long long sect_read;      //!< sectors read successfully
+    unsigned long long mill_read;      //!< milliseconds spent by all reads
+    unsigned long long writes_comp;    //!< writes completed successfully
+    unsigned long long sect_written;   //!< sectors written successfully
+    unsigned long long mill_written;   //!< milliseconds spent by all writes
+    unsigned long long ios_progress;   //!< I/Os currently in progress
+} ncDiskStat;
+
+//! Cgroup of a domain, as found by find_cgroup_domains()
+typedef struct ncCgroupDomain_t {
+    char name[CHAR_BUFFER_SIZE];       //!< name of the domain, i.e., the instance ID
+    char path[EUCA_MAX_PATH];          //!< directory of the cgroup of the domain
+} ncCgroupDomain;
+
+//! I/O counters of a cgroup on one block device, as read from io.stat or the blkio.throttle files
+typedef struct ncCgroupIo_t {
+    unsigned int major;                //!< major device number
+    unsigned int minor;                //!< minor device number
+    unsigned long long rbytes;         //!< bytes read
+    unsigned long long wbytes;         //!< bytes written
+    unsigned long long rios;           //!< reads completed
+    unsigned long long wios;           //!< writes completed
+} ncCgroupIo;
+
+//! Counters of a tap interface, as read from /sys/class/net
+typedef struct ncTapStat_t {
+    char mac[MAC_BUFFER_SIZE];         //!< address of the tap, which is that of the guest interface with fe as the first byte
+    unsigned long long rx_bytes;       //!< bytes the guest sent
+    unsigned long long tx_bytes;       //!< bytes sent to the guest
+} ncTapStat;
+
+//! Migration credentials put in place on this node, remembered so that repeated migrations with
+//! the same peer and shared secret do not redo them, see migration_keys_current()
+typedef struct migrationKeys_t {
+    char host[HOSTNAME_SIZE];          //!< the host the keys were generated for, or the peer authorized
+    char credentials[CREDENTIAL_SIZE]; //!< the shared secret in the keys
+    time_t expires;                    //!< when the keys stop being reused, 0 for an unused entry
+} migrationKeys;
+
+//! A read-only copy of an instance, shared by the snapshots and the requests that refer to it
+typedef struct sharedInstance_t {
+    ncInstance instance;               //!< the copy, first so that a pointer to it also points to its container
+    int refs;                          //!< number of snapshots and requests holding the copy, guarded by inst_copy_sem
+    long long disk_gb;                 //!< disk space, in GB, the instance takes up on the NC
+} sharedInstance;
+
+//! Running domains found at startup, handed out to the adoption workers
+typedef struct adoptionQueue_t {
+    int dom_ids[MAXDOMS];              //!< IDs of the running domains
+    int num_doms;                      //!< number of IDs in dom_ids
+    int next;                          //!< index of the next domain to adopt
+    pthread_mutex_t mutex;             //!< guards next
+} adoptionQueue;
+
+//! A step of NC initialization, run alongside the other steps of its stage, see run_init_phases()
+typedef struct initPhase_t {
+    const char *name;                  //!< name of the step, for the logs
+    int (*run) (void);                 //!< the step itself, returning EUCA_OK on success
+    int result;                        //!< what run() returned
+    long long usec;                    //!< how long run() took
+    pthread_t thread;                  //!< the thread that ran it
+    boolean spawned;                   //!< TRUE if it ran in a thread of its own
+} initPhase;
+
+//! A persistent hypervisor connection, which is only reopened once it is found dead
+typedef struct hypervisorConn_t {
+    virConnectPtr conn;                //!< the connection, or NULL if it could not be opened
+    boolean query;                     //!< TRUE for the connection shared by concurrent queries, FALSE for the one serialized by hyp_sem
+    volatile boolean closed;           //!< set by the close callback once libvirt gives up on the connection
+} hypervisorConn;
+
+//! Stages of the instance launch pipeline in startup_thread()
+typedef enum launchStageId_t {
+    LAUNCH_FETCH = 0,                  //!< downloading images and creating the disks of the instance
+    LAUNCH_PREPARE,                    //!< generating the instance and libvirt XML and running the pre-boot hooks
+    LAUNCH_DEFINE,                     //!< creating the domain in the hypervisor
+    LAUNCH_BOOT,                       //!< pulling lazily-booted disks and reporting the instance as booting
+    LAUNCH_STAGES,                     //!< number of stages, not a stage
+} launchStageId;
+
+//! Admission state and counters of a launch stage, guarded by launch_stages_mutex
+typedef struct launchStage_t {
+    const char *name;                  //!< name of the stage, for the logs and nc-stats
+    int limit;                         //!< number of launches allowed in the stage at once, or 0 for no limit
+    int active;                        //!< number of launches in the stage
+    int queued;                        //!< number of launches waiting to enter the stage
+    long long tickets;                 //!< number of launches that have asked to enter, which numbers them in arrival order
+    long long admitted;                //!< number of launches that have entered, so the ticket of the next one to enter
+    long long completed;               //!< number of launches that have left the stage
+    long long wait_usec;               //!< total time spent waiting to enter the stage
+    long long run_usec;                //!< total time spent in the stage
+    pthread_cond_t cond;               //!< broadcast when a launch enters or leaves the stage
+} launchStage;
+
+//! A domain being shut down by termination_thread()
+typedef struct pendingTermination_t {
+    char instanceId[CHAR_BUFFER_SIZE]; //!< the instance identifier string (i-XXXXXXXX)
+    time_t deadline;                   //!< when the domain is destroyed if it has not shut down, 0 until the shutdown is requested
+} pendingTermination;
+
+//! Memory use of a domain, as last sampled by sample_memory_density()
+typedef struct densityDomain_t {
+    char instanceId[CHAR_BUFFER_SIZE]; //!< the instance identifier string (i-XXXXXXXX)
+    long long mem_mb;                  //!< memory, in MB, the instance asked for
+    long long rss_kb;                  //!< memory, in KB, the domain takes up on the host
+    long long unused_kb;               //!< memory, in KB, the guest leaves unused, or -1 without balloon statistics
+} densityDomain;
+
+//! Instances whose backing is being destroyed by cleanup_thread()
+typedef struct cleanupBatch_t {
+    ncInstance *instances[MAXINSTANCES_PER_NC]; //!< copies of the instances, taken when they were condemned
+    boolean destroy_files[MAXINSTANCES_PER_NC]; //!< whether the files of each instance are removed
+    int len;                           //!< number of instances in the batch
+} cleanupBatch;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -198,10 +344,9 @@ sem *addkey_sem = NULL;                //!< guarding access to global instance s
 sem *loop_sem = NULL;                  //!< created in diskutils.c for serializing 'losetup' invocations
 sem *log_sem = NULL;                   //!< used by log.c
 sem *service_state_sem = NULL;         //!< Used to guard service state updates (i.e. topology updates)
-sem *stats_sem = NULL;                 //!< Used to guard the internal message stats data on updates
+sem *stats_sem = NULL;                 //!< Used to serialize the internal sensor passes
 
 bunchOfInstances *global_instances = NULL;  //!< pointer to the instance list
-bunchOfInstances *global_instances_copy = NULL; //!< pointer to the copied instance list
 
 const int default_staging_cleanup_threshold = 60 * 60 * 2;  //!< after this many seconds any STAGING domains will be cleaned up
 const int default_booting_cleanup_threshold = 60;   //!< after this many seconds any BOOTING domains will be cleaned up
@@ -217,6 +362,8 @@ configEntry configKeysRestartNC[] = {
     {"EUCALYPTUS", "/"},
     {"NC_PORT", "8775"},
     {"NC_SERVICE", "axis2/services/EucalyptusNC"},
+    {METRICS_LISTEN_CONF_PARAM_NAME, METRICS_LISTEN_CONF_PARAM_DEFAULT},
+    {EMITTER_MODE_CONF_PARAM_NAME, EMITTER_MODE_CONF_PARAM_DEFAULT},
     {NULL, NULL},
 };
 
@@ -226,9 +373,11 @@ configEntry configKeysNoRestartNC[] = {
     {"LOGMAXSIZE", "104857600"},
     {"LOGPREFIX", ""},
     {"LOGFACILITY", ""},
+    {"LOGASYNC", "N"},
     {CONFIG_NC_CEPH_USER, DEFAULT_CEPH_USER},
     {CONFIG_NC_CEPH_KEYS, DEFAULT_CEPH_KEYRING},
     {CONFIG_NC_CEPH_CONF, DEFAULT_CEPH_CONF},
+    {CONFIG_INSTANCE_QOS, ""},
     {SENSOR_LIST_CONF_PARAM_NAME, SENSOR_LIST_CONF_PARAM_DEFAULT},
     {NULL, NULL},
 };
@@ -248,6 +397,10 @@ static char *compile_timestamp_str = EUCA_COMPILE_TIMESTAMP;
 static char *compile_timestamp_str = "";
 #endif /* EUCA_COMPILE_TIMESTAMP */
 
+static long long instances_generation = 0;  //!< bumped by copy_instances() whenever an instance in the snapshot changes
+static instancesSnapshot *instances_snapshot = NULL;    //!< the published snapshot of global_instances, guarded by inst_copy_sem
+static euca_slab shared_instance_slab = EUCA_SLAB_INITIALIZER("sharedInstance", sharedInstance, SHARED_INSTANCE_SLAB_MAX_FREE);    //!< the copies in the snapshots
+
 //! a NULL-terminated array of available handlers
 static struct handlers *available_handlers[] = {
     &default_libvirt_handlers,
@@ -256,7 +409,48 @@ static struct handlers *available_handlers[] = {
     NULL,
 };
 
-static json_object *stats_json = NULL; //!< The json object that holds all of the internal message counters
+static boolean hyp_keepalive = FALSE; //!< TRUE once the libvirt event loop runs, so that dead connections are detected by keepalive
+static hypervisorConn hyp_conn = { NULL, FALSE, FALSE };    //!< connection for domain operations, used while holding hyp_sem
+static hypervisorConn hyp_query_conn = { NULL, TRUE, FALSE };   //!< connection for queries, used by up to LIBVIRT_QUERY_CALLERS threads at once
+static sem *hyp_query_sem = NULL;      //!< limits the number of concurrent users of the query connection
+static pthread_mutex_t hyp_query_mutex = PTHREAD_MUTEX_INITIALIZER; //!< serializes checks and reopening of the query connection
+
+static int domain_events_callback = -1; //!< ID of the lifecycle event callback on the query connection, or -1 without domain events
+static char domain_events[MAXINSTANCES_PER_NC][CHAR_BUFFER_SIZE];   //!< names of the domains with lifecycle events not yet handled
+static int domain_events_len = 0;      //!< number of names in domain_events
+static boolean domain_events_overflow = FALSE;  //!< set when an event was dropped, so that the next pass polls all instances
+static pthread_mutex_t domain_events_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards domain_events and the fields above
+static pthread_cond_t domain_events_cond = PTHREAD_COND_INITIALIZER;    //!< signaled when a domain event arrives
+
+static launchStage launch_stages[LAUNCH_STAGES] = {
+    {"fetch", 0, 0, 0, 0, 0, 0, 0, 0, PTHREAD_COND_INITIALIZER},
+    {"prepare", 0, 0, 0, 0, 0, 0, 0, 0, PTHREAD_COND_INITIALIZER},
+    {"define", 0, 0, 0, 0, 0, 0, 0, 0, PTHREAD_COND_INITIALIZER},
+    {"boot", 0, 0, 0, 0, 0, 0, 0, 0, PTHREAD_COND_INITIALIZER},
+};                                     //!< the launch pipeline, with limits set by init()
+static pthread_mutex_t launch_stages_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards launch_stages
+
+static pendingTermination terminations[MAXINSTANCES_PER_NC];    //!< domains handed to termination_thread() and not yet gone
+static int terminations_len = 0;       //!< number of entries in terminations
+static boolean termination_thread_running = FALSE;  //!< set once termination_thread() has been started
+static pthread_mutex_t terminations_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards terminations and the fields above
+static pthread_cond_t terminations_cond = PTHREAD_COND_INITIALIZER; //!< signaled when a termination is queued
+
+static cleanupBatch *cleanup_batch = NULL;  //!< the batch cleanup_thread() works on, NULL if none, guarded by inst_sem
+
+static migrationKeys generated_keys = { "", "", 0 };    //!< the keys last generated on this node
+static migrationKeys authorized_keys[MAXINSTANCES_PER_NC];  //!< the peers authorized to migrate to this node
+static boolean libvirtd_restart_needed = FALSE; //!< set when the authorized peers changed and libvirtd has not been restarted since
+static boolean deauthorize_pending = FALSE; //!< set when deauthorization was put off until the authorized keys expire
+static pthread_mutex_t migration_keys_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< guards the migration keys and the fields above
+
+static densityDomain density_domains[MAXINSTANCES_PER_NC];  //!< sampled memory use of the running domains
+static int density_domains_len = 0;    //!< number of domains in density_domains
+static long long density_shared_kb = 0; //!< memory, in KB, KSM saves by merging identical pages
+static pthread_mutex_t density_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< guards density_domains and the fields above
+
+static message_stats_state message_stats; //!< The internal message counters, updated without locking
+static trace_ring trace_spans;          //!< The spans of the requests served, for the /traces endpoint
 static int stats_sensor_interval_sec; //!< Keeps the current value for sensor interval. Set during init
 
 /*----------------------------------------------------------------------------*\
@@ -266,18 +460,74 @@ static int stats_sensor_interval_sec; //!< Keeps the current value for sensor in
 \*----------------------------------------------------------------------------*/
 
 static void *libvirt_thread(void *ptr);
+static void adopt_domain(int dom_id);
+static void *adopting_thread(void *arg);
+static boolean instance_copy_differs(const ncInstance * copy, const ncInstance * instance);
+static long long get_disk_use_gb(const virtualMachine * vm);
+static void add_resource_use(instancesSnapshot * snapshot, const sharedInstance * copy);
+static void announce_instance_changes(long long generation);
+static void unref_instances_snapshot(instancesSnapshot * snapshot);
+static void *libvirt_event_thread(void *ptr);
+static void libvirt_close_callback(virConnectPtr conn, int reason, void *opaque);
+static int init_hypervisor_events(void);
+static int check_hypervisor_conn(hypervisorConn * hc);
+static int libvirt_lifecycle_callback(virConnectPtr conn, virDomainPtr dom, int event, int detail, void *opaque);
+static boolean domain_events_live(void);
+static boolean instance_in_flux(ncInstance * instance);
+static void wait_for_domain_events(struct nc_state_t *nc, int period);
+static long long enter_launch_stage(ncInstance * instance, launchStageId id, int *span);
+static void leave_launch_stage(ncInstance * instance, launchStageId id, long long entered, int span);
+static void print_launch_stages(FILE * f);
+static int count_cpus(const char *cpulist);
+static void init_numa_topology(void);
+static void count_numa_usage(ncNumaNode * nodes, const ncInstance * instance);
+static void place_instance_numa(ncInstance * instance);
+static void print_numa_nodes(FILE * f, ncInstance ** instances, int instancesLen);
+static int read_diskstats(ncDiskStat ** pdisks);
+#if LIBVIR_VERSION_NUMBER >= 1002008
+static int collect_domain_stats(getstat *** pstats);
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+static boolean read_stat_file(const char *path, const char *key, unsigned long long *val);
+static boolean cgroup_domain_name(int layout, const char *entry, char *name, int len);
+static int find_cgroup_domains(const char *hierarchy, ncCgroupDomain ** pdomains);
+static ncCgroupDomain *find_cgroup_domain(ncCgroupDomain * domains, int ndomains, const char *name);
+static int read_cgroup_io(const char *dir, boolean unified, ncCgroupIo ** pios);
+static int read_tapstats(ncTapStat ** ptaps);
+static int collect_instance_disk_stats(getstat *** pstats, ncInstance * instance, long long ts, ncDiskStat * disks, int ndisks, ncCgroupIo * ios, int nios);
+static int collect_cgroup_stats(getstat *** pstats);
+static int collect_instance_stats(getstat *** pstats);
 static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance);
 static void update_log_params(void);
 static void update_ebs_params(void);
+static void update_qos_params(boolean live);
+static void init_memory_density(void);
+static void sample_memory_density(void);
+static void print_memory_density(FILE * f);
+#if LIBVIR_VERSION_NUMBER >= 1002008
+static int qos_domain(virConnectPtr conn, const ncInstance * instance, const qosProfile * profile, boolean apply);
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+static boolean qos_instance(const ncInstance * instance);
+static void pull_lazy_disks(ncInstance * instance);
+static void *termination_thread(void *arg);
+static void *cleanup_thread(void *arg);
+static void stop_instance_network(ncInstance * instance);
 static void nc_signal_handler(int sig);
+static int run_init_phases(const char *stage, initPhase * phases, int num_phases);
+static void *init_phase_thread(void *arg);
+static int init_hypervisor_phase(void);
+static int init_backing_phase(void);
+static int adopt_instances_phase(void);
+static int check_backing_phase(void);
+static int init_network_phase(void);
+static int init_identity_phase(void);
 static int init(void);
 static void updateServiceStateInfo(ncMetadata * pMeta, boolean authoritative);
 static void printNCServiceStateInfo(void);
 static void printMsgServiceStateInfo(ncMetadata * pMeta);
 
 //! Helpers for internal stats handling in the NC
-static json_object **message_stats_getter();
-static void message_stats_setter();
+static message_stats_state *message_stats_getter();
+static int qos_sensor_getter(qos_sensor_entry ** entries, int *entries_len);
 static int initialize_stats_system(int interval_sec);
 static void *nc_run_stats(void *ignored_arg);
 
@@ -341,19 +591,55 @@ static char *stats_service_state_call()
     }
 }
 
-//! Gets the reference to the stats json object, basically a no-op for the NC
-static json_object **message_stats_getter()
+//! Gets the reference to the message stats, which the NC keeps in process memory
+static message_stats_state *message_stats_getter()
 {
-    LOGTRACE("Fetching latest message stats from shared memory\n");
-    return &stats_json;
+    return &message_stats;
 }
 
-//! Updates the stats json data, literally a No-op for the NC (as opposed to the CC)
-static void message_stats_setter()
+//! Gets the caps of the instances with a QoS profile and whether libvirt enforces them,
+//! checked on the query connection so that domain operations do not hold up the sensor
+static int qos_sensor_getter(qos_sensor_entry ** entries, int *entries_len)
 {
-    LOGTRACE("Updating latest message stats from shared memory\n");
-    //No-op
-    return;
+    qosProfile profile = { {0} };
+    qos_sensor_entry *entry = NULL;
+    ncInstance *instance = NULL;
+    instancesSnapshot *snapshot = NULL;
+    virConnectPtr conn = NULL;
+
+    *entries = NULL;
+    *entries_len = 0;
+    if ((snapshot = acquire_instances_snapshot()) == NULL)
+        return (EUCA_OK);
+
+    if ((*entries = EUCA_ZALLOC((snapshot->instancesLen + 1), sizeof(qos_sensor_entry))) == NULL) {
+        release_instances_snapshot(snapshot);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    for (int i = 0; i < snapshot->instancesLen; i++) {
+        instance = snapshot->instances[i];
+        if (!qos_instance(instance) || !get_qos_profile(instance->params.name, &profile))
+            continue;
+
+        entry = &((*entries)[(*entries_len)++]);
+        euca_strncpy(entry->instance_id, instance->instanceId, sizeof(entry->instance_id));
+        euca_strncpy(entry->vm_type, instance->params.name, sizeof(entry->vm_type));
+        entry->disk_iops = profile.diskIops;
+        entry->disk_bytes = profile.diskBytes;
+        entry->net_in_kbs = profile.netInKBs;
+        entry->net_out_kbs = profile.netOutKBs;
+#if LIBVIR_VERSION_NUMBER >= 1002008
+        if (conn == NULL)
+            conn = lock_hypervisor_query_conn();
+        entry->enforced = ((conn != NULL) && (qos_domain(conn, instance, &profile, FALSE) == 1));
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+    }
+
+    if (conn)
+        unlock_hypervisor_query_conn(conn);
+    release_instances_snapshot(snapshot);
+    return (EUCA_OK);
 }
 
 void nc_lock_stats()
@@ -367,22 +653,11 @@ void nc_unlock_stats()
 }
 
 
-//! Update the message stat structure
-//! Wraps the message stats update with the necessary caching copies and locking
+//! Update the message stat structure. Lock-free, the counters are updated atomically
 int nc_update_message_stats(const char *message_name, long call_time, int msg_failed)
 {
     LOGTRACE("Updating message stats for message %s\n", message_name);
-
-    nc_lock_stats();    
-    json_object **stats_state = message_stats_getter();
-
-    //Update the counters
-    update_message_stats(*stats_state, message_name, call_time, msg_failed);
-    message_stats_setter();    
-
-    nc_unlock_stats();
-    LOGTRACE("Message stats update complete\n");
-    return EUCA_OK;
+    return update_message_stats(message_stats_getter(), message_name, call_time, msg_failed);
 }
 
 //! Provides NC-specific initializations for the stats system of
@@ -393,18 +668,16 @@ static int initialize_stats_system(int interval_sec) {
     int ret = EUCA_OK;
     int stats_ttl = interval_sec + 1;
     stats_sensor_interval_sec = interval_sec;
+    trace_init(&trace_spans);
     nc_lock_stats();
     {
         //Init the message sensor with component-specific data
-        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_getter, message_stats_setter);
+        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_getter);
         if(ret != EUCA_OK) {
             LOGERROR("Error initializing internal message sensor: %d\n", ret);
             goto cleanup;
         } else {
-            json_object **tmp = message_stats_getter();
-            const char *tmp_out = json_object_to_json_string(*tmp);
-            LOGINFO("Initialized internal message stats: %s\n", tmp_out);
-            
+            LOGINFO("Initialized internal message stats\n");
         }
         
         //Init the service state sensor with component-specific data
@@ -413,6 +686,36 @@ static int initialize_stats_system(int interval_sec) {
             LOGERROR("Error initializing internal service state sensor: %d\n", ret);
             goto cleanup;
         }
+
+        //Init the lock sensor, which reports on the semaphores registered in init()
+        ret = initialize_lock_sensor(euca_this_component_name, interval_sec, stats_ttl);
+        if(ret != EUCA_OK) {
+            LOGERROR("Error initializing internal lock sensor: %d\n", ret);
+            goto cleanup;
+        }
+
+#ifdef EUCA_ALLOC_TRACKING
+        //Init the allocation sensor, which reports on the counters of the EUCA_ALLOC() call sites and the slabs
+        ret = initialize_alloc_sensor(euca_this_component_name, interval_sec, stats_ttl);
+        if(ret != EUCA_OK) {
+            LOGERROR("Error initializing internal allocation sensor: %d\n", ret);
+            goto cleanup;
+        }
+#endif /* EUCA_ALLOC_TRACKING */
+
+        //Init the helper command sensor, which reports on the latencies of the commands run through euca_run()
+        ret = initialize_command_sensor(euca_this_component_name, interval_sec, stats_ttl);
+        if(ret != EUCA_OK) {
+            LOGERROR("Error initializing internal helper command sensor: %d\n", ret);
+            goto cleanup;
+        }
+
+        //Init the QoS sensor, which reports on the caps of the instances set from INSTANCE_QOS
+        ret = initialize_qos_sensor(euca_this_component_name, interval_sec, stats_ttl, qos_sensor_getter);
+        if(ret != EUCA_OK) {
+            LOGERROR("Error initializing internal QoS sensor: %d\n", ret);
+            goto cleanup;
+        }
         
         ret = init_stats(nc_state.home, euca_this_component_name, nc_lock_stats, nc_unlock_stats);
         if(ret != EUCA_OK) {
@@ -451,11 +754,38 @@ int authorize_migration_keys(char *options, char *host, char *credentials, ncIns
     char *euca_base = getenv(EUCALYPTUS_ENV_VAR_NAME);
     char *instanceId = instance ? instance->instanceId : "UNSET";
 
+    int i = 0;
+    int slot = -1;
+    boolean authorize = FALSE;
+    time_t now = time(NULL);
+
     if (!options && !host && !credentials) {
         LOGERROR("[%s] called with invalid arguments: options=%s, host=%s, creds=%s\n", SP(instanceId), SP(options), SP(host), (credentials == NULL) ? "UNSET" : "present");
         return (EUCA_INVALID_ERROR);
     }
 
+    // a peer already authorized with the same secret need not be authorized again
+    authorize = (options && !strcmp(options, "-a") && host && credentials);
+    if (authorize) {
+        pthread_mutex_lock(&migration_keys_mutex);
+        {
+            deauthorize_pending = FALSE;   // a migration is coming, whatever deauthorization was put off waits for it
+            for (i = 0; i < MAXINSTANCES_PER_NC; i++) {
+                if (authorized_keys[i].expires > now) {
+                    if (!strcmp(authorized_keys[i].host, host) && !strcmp(authorized_keys[i].credentials, credentials))
+                        break;
+                } else if (slot < 0) {
+                    slot = i;
+                }
+            }
+        }
+        pthread_mutex_unlock(&migration_keys_mutex);
+        if (i < MAXINSTANCES_PER_NC) {
+            LOGDEBUG("[%s] migration source %s is already authorized, skipping\n", SP(instanceId), host);
+            return (EUCA_OK);
+        }
+    }
+
     snprintf(command, EUCA_MAX_PATH, EUCALYPTUS_AUTHORIZE_MIGRATION_KEYS, NP(euca_base));
     snprintf(euca_rootwrap, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, NP(euca_base));
     LOGDEBUG("[%s] migration key authorization command: '%s %s %s %s %s'\n", SP(instanceId), euca_rootwrap, command, NP(options), NP(host), NP(credentials));
@@ -475,9 +805,125 @@ int authorize_migration_keys(char *options, char *host, char *credentials, ncIns
     } else {
         LOGDEBUG("[%s] migration key authorization/deauthorization succeeded\n", SP(instanceId));
     }
+
+    pthread_mutex_lock(&migration_keys_mutex);
+    {
+        if (authorize) {
+            // libvirtd reads the authorized peers when it starts
+            libvirtd_restart_needed = TRUE;
+            if ((slot >= 0) && (nc_state.migration_keys_ttl_sec > 0)) {
+                euca_strncpy(authorized_keys[slot].host, host, sizeof(authorized_keys[slot].host));
+                euca_strncpy(authorized_keys[slot].credentials, credentials, sizeof(authorized_keys[slot].credentials));
+                authorized_keys[slot].expires = now + nc_state.migration_keys_ttl_sec;
+            }
+        } else if (options && strstr(options, "-D")) {
+            bzero(authorized_keys, sizeof(authorized_keys));
+            deauthorize_pending = FALSE;
+            if (strstr(options, "-r"))
+                libvirtd_restart_needed = FALSE;
+        }
+    }
+    pthread_mutex_unlock(&migration_keys_mutex);
     return (EUCA_OK);
 }
 
+//!
+//! Tells whether the migration keys of this node were generated for a host and shared secret
+//! recently enough to be reused, in which case neither the keys need to be generated again nor
+//! libvirtd restarted, unless the authorized peers changed since libvirtd last started.
+//!
+//! @param[in] host hostname (IP address) the keys are for
+//! @param[in] credentials shared secret of the keys
+//!
+//! @return TRUE if the keys in place can be used as they are
+//!
+boolean migration_keys_current(const char *host, const char *credentials)
+{
+    boolean current = FALSE;
+
+    pthread_mutex_lock(&migration_keys_mutex);
+    {
+        current = ((generated_keys.expires > time(NULL)) && !libvirtd_restart_needed && !strcmp(generated_keys.host, host)
+                   && !strcmp(generated_keys.credentials, credentials));
+    }
+    pthread_mutex_unlock(&migration_keys_mutex);
+    return (current);
+}
+
+//!
+//! Records that the migration keys of this node were generated, see migration_keys_current()
+//!
+//! @param[in] host hostname (IP address) the keys are for
+//! @param[in] credentials shared secret of the keys
+//! @param[in] restarted TRUE if libvirtd was restarted along with the generation
+//!
+void migration_keys_generated(const char *host, const char *credentials, boolean restarted)
+{
+    pthread_mutex_lock(&migration_keys_mutex);
+    {
+        euca_strncpy(generated_keys.host, host, sizeof(generated_keys.host));
+        euca_strncpy(generated_keys.credentials, credentials, sizeof(generated_keys.credentials));
+        generated_keys.expires = ((nc_state.migration_keys_ttl_sec > 0) ? (time(NULL) + nc_state.migration_keys_ttl_sec) : 0);
+        if (restarted)
+            libvirtd_restart_needed = FALSE;
+    }
+    pthread_mutex_unlock(&migration_keys_mutex);
+}
+
+//!
+//! Deauthorizes all the migration peers of this node once no migration to it is left. With
+//! NC_MIGRATION_KEYS_TTL_SEC set, peers authorized recently are left in place until they expire,
+//! so that the next migration in a series, e.g., of a host evacuation, does not restart libvirtd
+//! twice more; expire_migration_keys() deauthorizes them then.
+//!
+//! @return EUCA_OK on success, or the error of authorize_migration_keys()
+//!
+int deauthorize_migration_keys(void)
+{
+    int i = 0;
+    boolean pending = FALSE;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&migration_keys_mutex);
+    {
+        for (i = 0; (i < MAXINSTANCES_PER_NC) && (authorized_keys[i].expires <= now); i++) ;
+        pending = deauthorize_pending = (i < MAXINSTANCES_PER_NC);
+    }
+    pthread_mutex_unlock(&migration_keys_mutex);
+
+    if (pending) {
+        LOGINFO("putting off deauthorization of migration client keys for up to %d seconds\n", nc_state.migration_keys_ttl_sec);
+        return (EUCA_OK);
+    }
+    LOGINFO("deauthorizing all migration client keys\n");
+    return (authorize_migration_keys("-D -r", NULL, NULL, NULL, FALSE));
+}
+
+//!
+//! Carries out a deauthorization put off by deauthorize_migration_keys() once the authorized
+//! keys expired. Called periodically by the monitoring thread.
+//!
+void expire_migration_keys(void)
+{
+    int i = 0;
+    boolean expired = FALSE;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&migration_keys_mutex);
+    {
+        if (deauthorize_pending) {
+            for (i = 0; (i < MAXINSTANCES_PER_NC) && (authorized_keys[i].expires <= now); i++) ;
+            expired = (i == MAXINSTANCES_PER_NC);
+        }
+    }
+    pthread_mutex_unlock(&migration_keys_mutex);
+
+    if (expired) {
+        LOGINFO("migration client keys expired -- deauthorizing them\n");
+        authorize_migration_keys("-D -r", NULL, NULL, NULL, FALSE);
+    }
+}
+
 //!
 //! Copies the url string of the ENABLED service of the requested type into dest_buffer.
 //! dest_buffer MUST be the same size as the services uri array length, 512.
@@ -862,1269 +1308,4297 @@ void print_running_domains(void)
 }
 
 //!
+//! Reads the counters of all block devices from /proc/diskstats.
 //!
+//! @param[out] pdisks set to an allocated array of devices, to be freed by the caller
 //!
-//! @param[in] ptr
+//! @return the number of devices in the array or -1 on failure
 //!
-static void *libvirt_thread(void *ptr)
+static int read_diskstats(ncDiskStat ** pdisks)
 {
-    int rc = 0;
-    sigset_t mask = { {0} };
+    int ndisks = 0;
+    int nalloc = 0;
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    unsigned long long reads_merg = 0;
+    unsigned long long writes_merg = 0;
+    char line[512] = "";
+    FILE *fp = NULL;
+    ncDiskStat d = { {0} };
+    ncDiskStat *disks = NULL;
+    ncDiskStat *tmp = NULL;
+
+    *pdisks = NULL;
+    if ((fp = fopen("/proc/diskstats", "r")) == NULL) {
+        LOGWARN("failed to open /proc/diskstats: %s\n", strerror(errno));
+        return (-1);
+    }
 
-    // allow SIGUSR1 signal to be delivered to this thread and its children
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGUSR1);
-    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        // see http://www.kernel.org/doc/Documentation/iostats.txt for the fields
+        if (sscanf(line, " %u %u %31s %llu %llu %llu %llu %llu %llu %llu %llu %llu", &major, &minor, d.name, &d.reads_comp, &reads_merg, &d.sect_read,
+                   &d.mill_read, &d.writes_comp, &writes_merg, &d.sect_written, &d.mill_written, &d.ios_progress) != 12)
+            continue;
 
-    if (nc_state.conn) {
-        if ((rc = virConnectClose(nc_state.conn)) != 0) {
-            LOGDEBUG("refcount on close was non-zero: %d\n", rc);
+        if (ndisks == nalloc) {
+            nalloc = (nalloc == 0) ? 64 : (nalloc * 2);
+            if ((tmp = EUCA_REALLOC(disks, nalloc, sizeof(ncDiskStat))) == NULL) {
+                EUCA_FREE(disks);
+                fclose(fp);
+                return (-1);
+            }
+            disks = tmp;
         }
+        d.major = major;
+        d.minor = minor;
+        disks[ndisks++] = d;
     }
-    nc_state.conn = virConnectOpen(nc_state.uri);
-    return (NULL);
+    fclose(fp);
+
+    *pdisks = disks;
+    return (ndisks);
 }
 
+#if LIBVIR_VERSION_NUMBER >= 1002008
 //!
-//! Checks and reset the hypervisor connection.
+//! Native replacement for the getstats.pl script: collects the CPU, network and
+//! disk counters of all running domains with one bulk libvirt call and one read
+//! of /proc/diskstats. The metrics, dimensions and units match those of the script.
+//! Called by the sensor polling thread, which already holds 'hyp_sem'.
 //!
-//! @return a pointer to the hypervisor connection structure or NULL if we failed.
+//! @param[in,out] pstats stats array to append the values to
 //!
-virConnectPtr lock_hypervisor_conn()
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int collect_domain_stats(getstat *** pstats)
 {
-    int rc = 0;
-    int status = 0;
-    pid_t cpid = 0;
-    pthread_t thread = { 0 };
-    long long thread_par = 0L;
-    boolean bail = FALSE;
-    struct timespec ts = { 0 };
-    virConnectPtr tmp_conn = NULL;
+#define BYTES_PER_SECTOR                         512
+#define MILLS_PER_SECOND                         1000.0
+
+    int rc = EUCA_OK;
+    int ndisks = 0;
+    int nrecords = 0;
+    long long ts = 0;
+    long long disk_ts = 0;
+    unsigned int j = 0;
+    unsigned int count = 0;
+    unsigned long long cpu_time = 0;
+    unsigned long long bytes = 0;
+    unsigned long long rx_bytes = 0;
+    unsigned long long tx_bytes = 0;
+    char key[VIR_TYPED_PARAM_FIELD_LENGTH] = "";
+    char dev_path[EUCA_MAX_PATH] = "";
+    const char *name = NULL;
+    const char *dim = NULL;
+    const char *path = NULL;
+    ncDiskStat *disks = NULL;
+    ncDiskStat *disk = NULL;
+    virConnectPtr conn = NULL;
+    virDomainStatsRecordPtr rec = NULL;
+    virDomainStatsRecordPtr *records = NULL;
 
-    // Acquire our hypervisor semaphore
-    sem_p(hyp_sem);
+    // the sensor thread serializes us with other hypervisor calls, so lock_hypervisor_conn() would deadlock
+    if ((conn = nc_state.conn) == NULL)
+        return (EUCA_ERROR);
 
-    if (call_hooks(NC_EVENT_PRE_HYP_CHECK, nc_state.home)) {
-        LOGFATAL("hooks prevented check on the hypervisor\n");
-        sem_v(hyp_sem);
-        return NULL;
+    if ((ndisks = read_diskstats(&disks)) < 0)
+        ndisks = 0;
+    disk_ts = time_ms();
+
+    nrecords = virConnectGetAllDomainStats(conn, VIR_DOMAIN_STATS_CPU_TOTAL | VIR_DOMAIN_STATS_INTERFACE | VIR_DOMAIN_STATS_BLOCK, &records,
+                                           VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+    if (nrecords < 0) {
+        LOGWARN("failed to obtain bulk domain stats from libvirt\n");
+        EUCA_FREE(disks);
+        return (EUCA_ERROR);
     }
-    // Fork off a process just to open and immediately close a libvirt connection.
-    // The purpose is to try to identify periods when open or close calls block indefinitely.
-    // Success in the child process does not guarantee success in the parent process, but
-    // hopefully it will flag certain bad conditions and will allow the parent to avoid them.
+    ts = time_ms();
 
-    if ((cpid = fork()) < 0) {         // fork error
-        LOGERROR("failed to fork to check hypervisor connection\n");
-        bail = TRUE;                   // we are in big trouble if we cannot fork
-    } else if (cpid == 0) {            // child process - checks on the connection
-        if ((tmp_conn = virConnectOpen(nc_state.uri)) == NULL)
-            exit(1);
-        virConnectClose(tmp_conn);
-        exit(0);
-    } else {                           // parent process - waits for the child, kills it if necessary
-        if ((rc = timewait(cpid, &status, LIBVIRT_TIMEOUT_SEC)) < 0) {
-            LOGERROR("failed to wait for forked process: %s\n", strerror(errno));
-            bail = TRUE;
-        } else if (rc == 0) {
-            LOGERROR("timed out waiting for hypervisor checker pid=%d\n", cpid);
-            bail = TRUE;
-        } else if (WEXITSTATUS(status) != 0) {
-            LOGERROR("child process failed to connect to hypervisor\n");
-            bail = TRUE;
+    for (int i = 0; (i < nrecords) && (rc == EUCA_OK); i++) {
+        rec = records[i];
+        if ((name = virDomainGetName(rec->dom)) == NULL)
+            continue;
+
+        // nanoseconds of CPU time used by the domain since it booted, reported in millis
+        if (virTypedParamsGetULLong(rec->params, rec->nparams, "cpu.time", &cpu_time) == 1)
+            rc |= getstat_append(pstats, name, ts, "CPUUtilization", SENSOR_SUMMATION, "default", (cpu_time / 1000000.0));
+
+        rx_bytes = tx_bytes = 0;
+        count = 0;
+        virTypedParamsGetUInt(rec->params, rec->nparams, "net.count", &count);
+        for (j = 0; j < count; j++) {
+            snprintf(key, sizeof(key), "net.%u.rx.bytes", j);
+            if (virTypedParamsGetULLong(rec->params, rec->nparams, key, &bytes) == 1)
+                rx_bytes += bytes;
+            snprintf(key, sizeof(key), "net.%u.tx.bytes", j);
+            if (virTypedParamsGetULLong(rec->params, rec->nparams, key, &bytes) == 1)
+                tx_bytes += bytes;
         }
-        // terminate the child, if any
-        killwait(cpid);
-    }
+        rc |= getstat_append(pstats, name, ts, "NetworkIn", SENSOR_SUMMATION, "total", rx_bytes);
+        rc |= getstat_append(pstats, name, ts, "NetworkOut", SENSOR_SUMMATION, "total", tx_bytes);
+
+        // only disks backed by a block device on this host have counters in /proc/diskstats
+        count = 0;
+        virTypedParamsGetUInt(rec->params, rec->nparams, "block.count", &count);
+        for (j = 0; (j < count) && (rc == EUCA_OK); j++) {
+            snprintf(key, sizeof(key), "block.%u.name", j);
+            if (virTypedParamsGetString(rec->params, rec->nparams, key, &dim) != 1)
+                continue;
+            snprintf(key, sizeof(key), "block.%u.path", j);
+            if (virTypedParamsGetString(rec->params, rec->nparams, key, &path) != 1)
+                continue;
+            if ((realpath(path, dev_path) == NULL) || strncmp(dev_path, "/dev/", 5))
+                continue;
 
-    if (bail) {
-        sem_v(hyp_sem);
-        return NULL;                   // better fail the operation than block the whole NC
+            disk = NULL;
+            for (int k = 0; k < ndisks; k++) {
+                if (!strcmp(disks[k].name, (dev_path + 5))) {
+                    disk = &disks[k];
+                    break;
+                }
+            }
+            if (disk == NULL)
+                continue;
+
+            rc |= getstat_append(pstats, name, disk_ts, "DiskReadOps", SENSOR_SUMMATION, dim, disk->reads_comp);
+            rc |= getstat_append(pstats, name, disk_ts, "DiskWriteOps", SENSOR_SUMMATION, dim, disk->writes_comp);
+            rc |= getstat_append(pstats, name, disk_ts, "DiskReadBytes", SENSOR_SUMMATION, dim, (disk->sect_read * BYTES_PER_SECTOR));
+            rc |= getstat_append(pstats, name, disk_ts, "DiskWriteBytes", SENSOR_SUMMATION, dim, (disk->sect_written * BYTES_PER_SECTOR));
+            rc |= getstat_append(pstats, name, disk_ts, "VolumeTotalReadTime", SENSOR_SUMMATION, dim, (disk->mill_read / MILLS_PER_SECOND));
+            rc |= getstat_append(pstats, name, disk_ts, "VolumeTotalWriteTime", SENSOR_SUMMATION, dim, (disk->mill_written / MILLS_PER_SECOND));
+            rc |= getstat_append(pstats, name, disk_ts, "VolumeQueueLength", SENSOR_LATEST, dim, disk->ios_progress);
+        }
     }
-    LOGTRACE("process check for libvirt succeeded\n");
 
-    // At this point, the check for libvirt done in a separate process was
-    // successful, so we proceed to close and reopen the connection in a
-    // separate thread, which we will try to wake up with SIGUSR1 if it
-    // blocks for too long (as a last-resource effort). The reason we reset
-    // the connection so often is because libvirt operations have a
-    // tendency to block indefinitely if we do not do this.
+    virDomainStatsRecordListFree(records);
+    EUCA_FREE(disks);
+    return ((rc == EUCA_OK) ? EUCA_OK : EUCA_ERROR);
 
-    if (pthread_create(&thread, NULL, libvirt_thread, (void *)&thread_par) != 0) {
-        LOGERROR("failed to create the libvirt refreshing thread\n");
-        bail = TRUE;
-    } else {
-        for (;;) {
-            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-                LOGERROR("failed to obtain time\n");
-                bail = TRUE;
-                break;
-            }
+#undef BYTES_PER_SECTOR
+#undef MILLS_PER_SECOND
+}
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
 
-            ts.tv_sec += LIBVIRT_TIMEOUT_SEC;
-            if ((rc = pthread_timedjoin_np(thread, NULL, &ts)) == 0)
-                break;                 // all is well
+//!
+//! Reads a counter from a cgroup or sysfs file, which either holds a single number or
+//! lines of "key value" pairs
+//!
+//! @param[in] path path of the file
+//! @param[in] key the key of the line holding the counter, or NULL if the file holds a single number
+//! @param[out] val the counter
+//!
+//! @return TRUE if the counter was read or FALSE otherwise
+//!
+static boolean read_stat_file(const char *path, const char *key, unsigned long long *val)
+{
+    FILE *fp = NULL;
+    boolean found = FALSE;
+    char line[256] = "";
+    char name[64] = "";
 
-            if (rc != ETIMEDOUT) {     // error other than timeout
-                LOGERROR("failed to wait for libvirt refreshing thread (rc=%d)\n", rc);
-                bail = TRUE;
-                break;
-            }
+    if ((fp = fopen(path, "r")) == NULL)
+        return (FALSE);
 
-            LOGERROR("timed out on libvirt refreshing thread\n");
-            pthread_kill(thread, SIGUSR1);
-            sleep(1);
+    while (!found && fgets(line, sizeof(line), fp)) {
+        if (key == NULL) {
+            found = (sscanf(line, "%llu", val) == 1);
+            break;
         }
+        found = ((sscanf(line, "%63s %llu", name, val) == 2) && !strcmp(name, key));
     }
+    fclose(fp);
+    return (found);
+}
 
-    if (bail) {
-        sem_v(hyp_sem);
-        return NULL;
+//!
+//! Gets the name of a domain from the name of its cgroup directory in one of the
+//! layouts libvirt has used over the years:
+//!     0: machine.slice/machine-qemu\x2d<id>\x2d<name>.scope (systemd)
+//!     1: machine/<name>.libvirt-qemu
+//!     2: libvirt/qemu/<name>
+//!
+//! @param[in] layout index of the layout of the directory name
+//! @param[in] entry name of the cgroup directory
+//! @param[out] name buffer for the name of the domain
+//! @param[in] len size of the name buffer
+//!
+//! @return TRUE if the directory is that of a domain or FALSE otherwise
+//!
+static boolean cgroup_domain_name(int layout, const char *entry, char *name, int len)
+{
+    int i = 0;
+    int n = 0;
+    unsigned int c = 0;
+    size_t elen = strlen(entry);
+    char unescaped[CHAR_BUFFER_SIZE] = "";
+    char *p = NULL;
+
+    switch (layout) {
+    case 0:
+        if (strncmp(entry, "machine-qemu", 12) || (elen < 18) || strcmp((entry + elen - 6), ".scope"))
+            return (FALSE);
+        // systemd escapes the dashes in the unit name as \x2d
+        for (i = 12; (i < (elen - 6)) && (n < (sizeof(unescaped) - 1)); i++) {
+            if ((entry[i] == '\\') && (entry[i + 1] == 'x') && (sscanf((entry + i + 2), "%2x", &c) == 1)) {
+                unescaped[n++] = (char)c;
+                i += 3;
+            } else {
+                unescaped[n++] = entry[i];
+            }
+        }
+        unescaped[n] = '\0';
+        // what is left is -<id>-<name>
+        if ((unescaped[0] != '-') || ((p = strchr((unescaped + 1), '-')) == NULL) || (*(p + 1) == '\0'))
+            return (FALSE);
+        euca_strncpy(name, (p + 1), len);
+        return (TRUE);
+    case 1:
+        if ((elen <= 13) || strcmp((entry + elen - 13), ".libvirt-qemu"))
+            return (FALSE);
+        if ((elen - 13) >= len)
+            return (FALSE);
+        memcpy(name, entry, (elen - 13));
+        name[elen - 13] = '\0';
+        return (TRUE);
+    case 2:
+        if (entry[0] == '.')
+            return (FALSE);
+        euca_strncpy(name, entry, len);
+        return (TRUE);
+    default:
+        break;
     }
-    LOGTRACE("thread check for libvirt succeeded\n");
+    return (FALSE);
+}
 
-    if (nc_state.conn == NULL) {
-        LOGERROR("failed to connect to %s\n", nc_state.uri);
-        sem_v(hyp_sem);
-        return NULL;
+//!
+//! Finds the cgroups of the domains under a hierarchy
+//!
+//! @param[in] hierarchy directory of the cgroup hierarchy, e.g. /sys/fs/cgroup or /sys/fs/cgroup/cpuacct
+//! @param[out] pdomains array of the cgroups found, which the caller must free
+//!
+//! @return the number of cgroups found or -1 if the hierarchy has no domain cgroups at all
+//!
+static int find_cgroup_domains(const char *hierarchy, ncCgroupDomain ** pdomains)
+{
+    static const char *parents[] = { "machine.slice", "machine", "libvirt/qemu" };
+    int ndomains = 0;
+    int nparents = 0;
+    char dir[EUCA_MAX_PATH] = "";
+    DIR *dp = NULL;
+    struct dirent *de = NULL;
+    ncCgroupDomain *domains = NULL;
+    ncCgroupDomain *tmp = NULL;
+
+    *pdomains = NULL;
+    for (int layout = 0; layout < (sizeof(parents) / sizeof(parents[0])); layout++) {
+        snprintf(dir, sizeof(dir), "%s/%s", hierarchy, parents[layout]);
+        if ((dp = opendir(dir)) == NULL)
+            continue;
+
+        nparents++;
+        while ((de = readdir(dp)) != NULL) {
+            if ((de->d_type != DT_DIR) && (de->d_type != DT_UNKNOWN))
+                continue;
+            if ((tmp = EUCA_REALLOC(domains, (ndomains + 1), sizeof(ncCgroupDomain))) == NULL)
+                break;
+            domains = tmp;
+            if (!cgroup_domain_name(layout, de->d_name, domains[ndomains].name, sizeof(domains[ndomains].name)))
+                continue;
+            snprintf(domains[ndomains].path, sizeof(domains[ndomains].path), "%s/%s", dir, de->d_name);
+            ndomains++;
+        }
+        closedir(dp);
+    }
+
+    if (nparents == 0) {
+        EUCA_FREE(domains);
+        return (-1);
     }
-    return nc_state.conn;
+    *pdomains = domains;
+    return (ndomains);
 }
 
 //!
-//! Closes the connection with the hypervisor
+//! Looks up the cgroup of a domain
 //!
-void unlock_hypervisor_conn()
+//! @param[in] domains array of cgroups from find_cgroup_domains()
+//! @param[in] ndomains number of cgroups in the array
+//! @param[in] name name of the domain
+//!
+//! @return a pointer to the cgroup of the domain or NULL if there is none
+//!
+static ncCgroupDomain *find_cgroup_domain(ncCgroupDomain * domains, int ndomains, const char *name)
 {
-    sem_v(hyp_sem);
+    for (int i = 0; i < ndomains; i++) {
+        if (!strcmp(domains[i].name, name))
+            return (&domains[i]);
+    }
+    return (NULL);
 }
 
 //!
-//! Instance state state machine.
+//! Reads the per-device I/O counters of a cgroup, from io.stat under the unified hierarchy
+//! or from the blkio.throttle files under the v1 blkio one
 //!
-//! @param[in] instance a pointer to the instance to modify
-//! @param[in] state the new instance state
+//! @param[in] dir directory of the cgroup
+//! @param[in] unified TRUE if the cgroup is in the unified (v2) hierarchy
+//! @param[out] pios array of the counters, which the caller must free
 //!
-void change_state(ncInstance * instance, instance_states state)
+//! @return the number of devices read or -1 if the counters could not be read
+//!
+static int read_cgroup_io(const char *dir, boolean unified, ncCgroupIo ** pios)
 {
-    int old_state = instance->state;
+    int nios = 0;
+    int j = 0;
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    unsigned long long val = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char line[512] = "";
+    char op[32] = "";
+    char *tok = NULL;
+    char *saveptr = NULL;
+    FILE *fp = NULL;
+    ncCgroupIo *ios = NULL;
+    ncCgroupIo *tmp = NULL;
+    ncCgroupIo *io = NULL;
+    static const char *v1_files[] = { "blkio.throttle.io_service_bytes", "blkio.throttle.io_serviced" };
+
+    *pios = NULL;
+    for (int f = 0; f < (unified ? 1 : 2); f++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, (unified ? "io.stat" : v1_files[f]));
+        if ((fp = fopen(path, "r")) == NULL) {
+            EUCA_FREE(ios);
+            return (-1);
+        }
 
-    instance->state = ((int)state);
-    switch (state) {                   /* mapping from NC's internal states into external ones */
-    case STAGING:
-    case CANCELED:
-        instance->stateCode = PENDING;
-        break;
-    case BOOTING:
-    case RUNNING:
-    case BLOCKED:
-    case PAUSED:
-        instance->stateCode = EXTANT;
-        instance->retries = LIBVIRT_QUERY_RETRIES;
-        break;
-    case CRASHED:
-    case BUNDLING_SHUTDOWN:
-    case BUNDLING_SHUTOFF:
-    case CREATEIMAGE_SHUTDOWN:
-    case CREATEIMAGE_SHUTOFF:
-    case SHUTDOWN:
-    case SHUTOFF:
-        if (instance->stateCode != EXTANT) {
-            instance->stateCode = PENDING;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "%u:%u", &major, &minor) != 2)
+                continue;
+
+            io = NULL;
+            for (j = 0; j < nios; j++) {
+                if ((ios[j].major == major) && (ios[j].minor == minor)) {
+                    io = &ios[j];
+                    break;
+                }
+            }
+            if (io == NULL) {
+                if ((tmp = EUCA_REALLOC(ios, (nios + 1), sizeof(ncCgroupIo))) == NULL)
+                    break;
+                ios = tmp;
+                io = &ios[nios++];
+                bzero(io, sizeof(ncCgroupIo));
+                io->major = major;
+                io->minor = minor;
+            }
+
+            if (unified) {
+                // 8:16 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0
+                for (tok = strtok_r(line, " \n", &saveptr); tok; tok = strtok_r(NULL, " \n", &saveptr)) {
+                    if (sscanf(tok, "rbytes=%llu", &val) == 1)
+                        io->rbytes = val;
+                    else if (sscanf(tok, "wbytes=%llu", &val) == 1)
+                        io->wbytes = val;
+                    else if (sscanf(tok, "rios=%llu", &val) == 1)
+                        io->rios = val;
+                    else if (sscanf(tok, "wios=%llu", &val) == 1)
+                        io->wios = val;
+                }
+            } else if (sscanf(line, "%*u:%*u %31s %llu", op, &val) == 2) {
+                // 8:16 Read 1459200
+                if (!strcmp(op, "Read")) {
+                    if (f == 0)
+                        io->rbytes = val;
+                    else
+                        io->rios = val;
+                } else if (!strcmp(op, "Write")) {
+                    if (f == 0)
+                        io->wbytes = val;
+                    else
+                        io->wios = val;
+                }
+            }
         }
-        instance->retries = LIBVIRT_QUERY_RETRIES;
-        break;
-    case TEARDOWN:
-        instance->stateCode = TEARDOWN;
-        break;
-    default:
-        LOGERROR("[%s] unexpected state (%d)\n", instance->instanceId, instance->state);
-        return;
+        fclose(fp);
     }
 
-    euca_strncpy(instance->stateName, instance_state_names[instance->stateCode], CHAR_BUFFER_SIZE);
-    if (old_state != state) {
-        LOGDEBUG("[%s] state change for instance: %s -> %s (%s)\n",
-                 instance->instanceId, instance_state_names[old_state], instance_state_names[instance->state], instance_state_names[instance->stateCode]);
-    }
+    *pios = ios;
+    return (nios);
 }
 
 //!
-//! waits indefinitely until a state transition takes place  (timeouts are implemented in the
-//! monitoring thread) and returns 0 if from_state->to_state transition takes place and 1 otherwise
+//! Reads the byte counters of the tap interfaces of the host, recognized by their addresses
+//! starting with fe, which is how libvirt derives them from the guest's
 //!
-//! @param[in] instance a pointer to the instance we're monitoring
-//! @param[in] from_state the starting state of the transition
-//! @param[in] to_state the ending state of the transition
+//! @param[out] ptaps array of the counters, which the caller must free
 //!
-//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//! @return the number of taps read or -1 if /sys/class/net could not be read
 //!
-int wait_state_transition(ncInstance * instance, instance_states from_state, instance_states to_state)
+static int read_tapstats(ncTapStat ** ptaps)
 {
-    instance_states current_state = NO_STATE;
-
-    while (1) {
-        current_state = instance->state;
-        if (current_state == to_state)
-            return (EUCA_OK);
+    int ntaps = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char mac[MAC_BUFFER_SIZE] = "";
+    FILE *fp = NULL;
+    DIR *dp = NULL;
+    struct dirent *de = NULL;
+    ncTapStat *taps = NULL;
+    ncTapStat *tmp = NULL;
+
+    *ptaps = NULL;
+    if ((dp = opendir(SYS_CLASS_NET_PATH)) == NULL)
+        return (-1);
+
+    while ((de = readdir(dp)) != NULL) {
+        if (de->d_name[0] == '.')
+            continue;
 
-        if (current_state != from_state)
-            return (EUCA_ERROR);
+        snprintf(path, sizeof(path), SYS_CLASS_NET_PATH "/%s/address", de->d_name);
+        if ((fp = fopen(path, "r")) == NULL)
+            continue;
+        mac[0] = '\0';
+        if (fscanf(fp, "%17s", mac) != 1)
+            mac[0] = '\0';
+        fclose(fp);
+        if (strncasecmp(mac, "fe:", 3))
+            continue;
 
-        // no point in checking more frequently
-        sleep(MONITORING_PERIOD);
+        if ((tmp = EUCA_REALLOC(taps, (ntaps + 1), sizeof(ncTapStat))) == NULL)
+            break;
+        taps = tmp;
+        bzero(&taps[ntaps], sizeof(ncTapStat));
+        euca_strncpy(taps[ntaps].mac, mac, sizeof(taps[ntaps].mac));
+        snprintf(path, sizeof(path), SYS_CLASS_NET_PATH "/%s/statistics/rx_bytes", de->d_name);
+        read_stat_file(path, NULL, &taps[ntaps].rx_bytes);
+        snprintf(path, sizeof(path), SYS_CLASS_NET_PATH "/%s/statistics/tx_bytes", de->d_name);
+        read_stat_file(path, NULL, &taps[ntaps].tx_bytes);
+        ntaps++;
     }
-    return (EUCA_ERROR);
+    closedir(dp);
+
+    *ptaps = taps;
+    return (ntaps);
 }
 
 //!
-//! Refresh instance information.
+//! Appends the counters of the block devices backing the disks and volumes of an instance,
+//! taking the operations and bytes from the cgroup of the domain when it has them, since
+//! those only count the I/O of the domain, and the rest from /proc/diskstats
 //!
-//! (This is called while holding inst_sem.)
+//! @param[in,out] pstats stats array to append the values to
+//! @param[in] instance the instance
+//! @param[in] ts timestamp of the counters
+//! @param[in] disks block device counters from read_diskstats()
+//! @param[in] ndisks number of block devices
+//! @param[in] ios counters of the cgroup of the domain from read_cgroup_io()
+//! @param[in] nios number of devices with cgroup counters
 //!
-//! @param[in] nc a pointer to the global NC state structure.
-//! @param[in] instance a pointer to the instance being refreshed
+//! @return EUCA_OK on success or EUCA_ERROR on failure
 //!
-static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
+static int collect_instance_disk_stats(getstat *** pstats, ncInstance * instance, long long ts, ncDiskStat * disks, int ndisks, ncCgroupIo * ios, int nios)
 {
-    int error = 0;
-    int rc = 0;
-    char *ip = NULL;
-    virDomainInfo info = { 0 };
-    instance_states new_state = NO_STATE;
-    instance_states old_state = instance->state;
-
-    // no need to bug for domains without state on Hypervisor
-    if (old_state == TEARDOWN || old_state == STAGING || old_state == BUNDLING_SHUTOFF || old_state == CREATEIMAGE_SHUTOFF)
-        return;
-
-    {                                  // all this is done while holding the hypervisor lock, with a valid connection
-        virConnectPtr conn = lock_hypervisor_conn();
-        if (conn == NULL)
-            return;
+#define BYTES_PER_SECTOR                         512
+#define MILLS_PER_SECOND                         1000.0
+
+    int rc = EUCA_OK;
+    int k = 0;
+    char xml_path[EUCA_MAX_PATH] = "";
+    char dev_path[EUCA_MAX_PATH] = "";
+    char **srcs = NULL;
+    char **dims = NULL;
+    const char *name = instance->instanceId;
+    ncDiskStat *disk = NULL;
+    ncCgroupIo *io = NULL;
+
+    // the domain XML lists the disks it booted with, the volume XMLs those attached since
+    for (int v = -1; (v < EUCA_MAX_VOLUMES) && (rc == EUCA_OK); v++) {
+        if (v < 0) {
+            srcs = get_xpath_content(instance->libvirtFilePath, "/domain/devices/disk[source/@dev]/source/@dev");
+            dims = get_xpath_content(instance->libvirtFilePath, "/domain/devices/disk[source/@dev]/target/@dev");
+        } else {
+            if (!is_volume_used(&instance->volumes[v]))
+                continue;
+            snprintf(xml_path, sizeof(xml_path), EUCALYPTUS_VOLUME_LIBVIRT_XML_PATH_FORMAT, instance->instancePath, instance->volumes[v].volumeId);
+            srcs = get_xpath_content(xml_path, "/disk[source/@dev]/source/@dev");
+            dims = get_xpath_content(xml_path, "/disk[source/@dev]/target/@dev");
+        }
 
-        virDomainPtr dom = virDomainLookupByName(conn, instance->instanceId);
+        for (int i = 0; srcs && dims && srcs[i] && dims[i] && (rc == EUCA_OK); i++) {
+            // only disks backed by a block device on this host have counters
+            if ((realpath(srcs[i], dev_path) == NULL) || strncmp(dev_path, "/dev/", 5))
+                continue;
 
-        if (dom == NULL) {             // hypervisor doesn't know about it
-            if (old_state == BUNDLING_SHUTDOWN) {
-                LOGINFO("[%s] detected disappearance of bundled domain\n", instance->instanceId);
-                change_state(instance, BUNDLING_SHUTOFF);
-            } else if (old_state == CREATEIMAGE_SHUTDOWN) {
-                LOGINFO("[%s] detected disappearance of createImage domain\n", instance->instanceId);
-                change_state(instance, CREATEIMAGE_SHUTOFF);
-            } else if (old_state == RUNNING || old_state == BLOCKED || old_state == PAUSED || old_state == SHUTDOWN) {
-                // If we just finished migration, then this is normal.
-                //
-                // Could this be a bad assumption if the
-                // virDomainLookupByName() call above returns NULL for
-                // some transient reason rather than because hypervisor
-                // doesn't know of the domain any more?
-                if (is_migration_src(instance)) {
-                    if (instance->migration_state == MIGRATION_IN_PROGRESS) {
-                        // This usually occurs when there has been some
-                        // glitch in the migration: an i/o error or
-                        // reset connction.  When that happens, we do
-                        // *not* want to shut off the instance!
-                        //
-                        // It can also happen absent an anomaly, such as
-                        // when refresh_instance_info() is called right
-                        // as the migration is completing (there's a race).
-                        LOGDEBUG("[%s] possible migration anomaly, not yet assuming completion\n", instance->instanceId);
-                        unlock_hypervisor_conn();
-                        return;
-                    }
-                    LOGINFO("[%s] migration completed (state='%s'), cleaning up\n", instance->instanceId, migration_state_names[instance->migration_state]);
-                    change_state(instance, SHUTOFF);
-                    unlock_hypervisor_conn();
-                    return;
-                }
-                // most likely the user has shut it down from the inside
-                if (instance->stop_requested) {
-                    LOGDEBUG("[%s] ignoring domain in stopped state\n", instance->instanceId);
-                } else if (instance->terminationRequestedTime) {
-                    LOGDEBUG("[%s] hypervisor not finding the terminating domain\n", instance->instanceId);
-                } else if (instance->retries) {
-                    LOGWARN("[%s] hypervisor failed to find domain, will retry %d more time(s)\n", instance->instanceId, instance->retries);
-                    instance->retries--;
-                } else {
-                    LOGWARN("[%s] hypervisor failed to find domain, assuming it was shut off\n", instance->instanceId);
-                    change_state(instance, SHUTOFF);
+            disk = NULL;
+            for (k = 0; k < ndisks; k++) {
+                if (!strcmp(disks[k].name, (dev_path + 5))) {
+                    disk = &disks[k];
+                    break;
                 }
             }
-            // else 'old_state' stays in SHUTFOFF, BOOTING, CANCELED, or CRASHED
-
-            // set guest power state
-            strncpy(instance->guestStateName, GUEST_STATE_POWERED_OFF, CHAR_BUFFER_SIZE);
-
-            // persist state updates to disk
-            save_instance_struct(instance);
-
-            unlock_hypervisor_conn();
-            return;
-        }
-
-        error = virDomainGetInfo(dom, &info);
-        if ((error < 0) || (info.state == VIR_DOMAIN_NOSTATE)) {
-            LOGWARN("[%s] failed to get information for domain\n", instance->instanceId);
-            // what to do? hopefully we'll find out more later
-            virDomainFree(dom);
-            unlock_hypervisor_conn();
-            return;
-        }
-
-        new_state = info.state;
-        switch (old_state) {
-        case BOOTING:
-        case RUNNING:
-        case BLOCKED:
-        case PAUSED:
-            // migration-related logic
-            if (is_migration_dst(instance)) {
-                if (old_state == BOOTING && new_state == PAUSED) {
-                    incoming_migrations_in_progress++;
-                    LOGINFO("[%s] incoming (%s < %s) migration in progress (1 of %d)\n", instance->instanceId, instance->migration_dst, instance->migration_src,
-                            incoming_migrations_in_progress);
-                    instance->migration_state = MIGRATION_IN_PROGRESS;
-                    LOGDEBUG("[%s] incoming (%s < %s) migration_state set to '%s'\n", instance->instanceId,
-                             instance->migration_dst, instance->migration_src, migration_state_names[instance->migration_state]);
+            if (disk == NULL)
+                continue;
 
-                } else if ((old_state == BOOTING || old_state == PAUSED)
-                           && (new_state == RUNNING || new_state == BLOCKED)) {
-                    LOGINFO("[%s] completing incoming (%s < %s) migration...\n", instance->instanceId, instance->migration_dst, instance->migration_src);
-                    instance->migration_state = NOT_MIGRATING;  // done!
-                    bzero(instance->migration_src, HOSTNAME_SIZE);
-                    bzero(instance->migration_dst, HOSTNAME_SIZE);
-                    bzero(instance->migration_credentials, CREDENTIAL_SIZE);
-                    instance->migrationTime = 0;
-                    save_instance_struct(instance);
-                    // copy_intances is called upon return in monitoring_thread().
-                    incoming_migrations_in_progress--;
-                    LOGINFO("[%s] incoming migration complete (%d other incoming migration[s] actively in progress)\n", instance->instanceId, incoming_migrations_in_progress);
-                    // If no remaining incoming or pending migrations, deauthorize all clients.
-                    // TO-DO: Consolidate with similar sequence in handlers_kvm.c into a utility function?
-                    if (!incoming_migrations_in_progress) {
-                        int incoming_migrations_pending = 0;
-                        int incoming_migrations_counted = 0;
-                        LOGINFO("no remaining active incoming migrations -- checking to see if there are any pending migrations\n");
-                        bunchOfInstances *head = NULL;
-                        for (head = global_instances; head; head = head->next) {
-                            if ((head->instance->migration_state == MIGRATION_PREPARING) || (head->instance->migration_state == MIGRATION_READY)) {
-                                LOGINFO("[%s] is pending migration, migration_state='%s', deferring deauthorization of migration keys\n", head->instance->instanceId,
-                                        migration_state_names[head->instance->migration_state]);
-                                incoming_migrations_pending++;
-                            }
-                            // Belt and suspenders...
-                            if ((head->instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, head->instance->migration_dst)) {
-                                LOGWARN("[%s] Possible internal bug detected: instance migration_state='%s', but incoming_migrations_in_progress=%d\n", head->instance->instanceId,
-                                        migration_state_names[head->instance->migration_state], incoming_migrations_in_progress);
-                                incoming_migrations_counted++;
-                            }
-                        }
-                        if (incoming_migrations_counted != incoming_migrations_in_progress) {
-                            LOGWARN("Possible internal bug detected: incoming_migrations_in_progress=%d, but %d incoming migrations counted\n", incoming_migrations_in_progress,
-                                    incoming_migrations_counted);
-                        }
-                        if (!incoming_migrations_pending) {
-                            LOGINFO("no remaining incoming or pending migrations -- deauthorizing all migration client keys\n");
-                            authorize_migration_keys("-D -r", NULL, NULL, NULL, FALSE);
-                        }
-                    } else {
-                        // Verify that our count of incoming_migrations_in_progress matches our version of reality.
-                        bunchOfInstances *head = NULL;
-                        int incoming_migrations_counted = 0;
-                        for (head = global_instances; head; head = head->next) {
-                            if ((head->instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, head->instance->migration_dst)) {
-                                incoming_migrations_counted++;
-                            }
-                        }
-                        if (incoming_migrations_counted != incoming_migrations_in_progress) {
-                            LOGWARN("Possible internal bug detected: incoming_migrations_in_progress=%d, but %d incoming migrations counted\n", incoming_migrations_in_progress,
-                                    incoming_migrations_counted);
-                        }
-                    }
-                } else if (new_state == SHUTOFF || new_state == SHUTDOWN) {
-                    // this is normal at the beginning of incoming migration, before a domain is created in PAUSED state
+            io = NULL;
+            for (k = 0; k < nios; k++) {
+                if ((ios[k].major == disk->major) && (ios[k].minor == disk->minor)) {
+                    io = &ios[k];
                     break;
                 }
             }
 
-            if (new_state == SHUTOFF || new_state == SHUTDOWN || new_state == CRASHED) {
-                LOGWARN("[%s] hypervisor reported previously running domain as %s\n", instance->instanceId, instance_state_names[new_state]);
-            }
-            // change to state, whatever it happens to be
-            change_state(instance, new_state);
-            break;
-        case SHUTDOWN:
-        case SHUTOFF:
-        case CRASHED:
-            if (new_state == RUNNING || new_state == BLOCKED || new_state == PAUSED) {
-                // cannot go back!
-                LOGWARN("[%s] detected prodigal domain, terminating it\n", instance->instanceId);
-                virDomainDestroy(dom);
+            if (io) {
+                rc |= getstat_append(pstats, name, ts, "DiskReadOps", SENSOR_SUMMATION, dims[i], io->rios);
+                rc |= getstat_append(pstats, name, ts, "DiskWriteOps", SENSOR_SUMMATION, dims[i], io->wios);
+                rc |= getstat_append(pstats, name, ts, "DiskReadBytes", SENSOR_SUMMATION, dims[i], io->rbytes);
+                rc |= getstat_append(pstats, name, ts, "DiskWriteBytes", SENSOR_SUMMATION, dims[i], io->wbytes);
             } else {
-                change_state(instance, new_state);
+                rc |= getstat_append(pstats, name, ts, "DiskReadOps", SENSOR_SUMMATION, dims[i], disk->reads_comp);
+                rc |= getstat_append(pstats, name, ts, "DiskWriteOps", SENSOR_SUMMATION, dims[i], disk->writes_comp);
+                rc |= getstat_append(pstats, name, ts, "DiskReadBytes", SENSOR_SUMMATION, dims[i], (disk->sect_read * BYTES_PER_SECTOR));
+                rc |= getstat_append(pstats, name, ts, "DiskWriteBytes", SENSOR_SUMMATION, dims[i], (disk->sect_written * BYTES_PER_SECTOR));
             }
-            break;
-        case BUNDLING_SHUTDOWN:
-        case CREATEIMAGE_SHUTDOWN:
-            LOGDEBUG("[%s] hypervisor state for bundle/createImage domain is %s\n", instance->instanceId, instance_state_names[new_state]);
-            break;
-        default:
-            LOGERROR("[%s] unexpected state (%d) in refresh\n", instance->instanceId, old_state);
+            rc |= getstat_append(pstats, name, ts, "VolumeTotalReadTime", SENSOR_SUMMATION, dims[i], (disk->mill_read / MILLS_PER_SECOND));
+            rc |= getstat_append(pstats, name, ts, "VolumeTotalWriteTime", SENSOR_SUMMATION, dims[i], (disk->mill_written / MILLS_PER_SECOND));
+            rc |= getstat_append(pstats, name, ts, "VolumeQueueLength", SENSOR_LATEST, dims[i], disk->ios_progress);
         }
 
-        virDomainFree(dom);
-        unlock_hypervisor_conn();
+        for (int i = 0; srcs && srcs[i]; i++)
+            EUCA_FREE(srcs[i]);
+        for (int i = 0; dims && dims[i]; i++)
+            EUCA_FREE(dims[i]);
+        EUCA_FREE(srcs);
+        EUCA_FREE(dims);
     }
 
-    // if instance is running, try to find out its IP address
-    if (instance->state == RUNNING || instance->state == BLOCKED || instance->state == PAUSED) {
-        ip = NULL;
+    return ((rc == EUCA_OK) ? EUCA_OK : EUCA_ERROR);
 
-        if (!strncmp(instance->ncnet.publicIp, "0.0.0.0", IP_BUFFER_SIZE)) {
-            if (!strcmp(nc_state.vnetconfig->mode, "SYSTEM") || !strcmp(nc_state.vnetconfig->mode, "STATIC")) {
-                rc = mac2ip(nc_state.vnetconfig, instance->ncnet.privateMac, &ip);
-                if (!rc && ip) {
-                    LOGINFO("[%s] discovered public IP %s for instance\n", instance->instanceId, ip);
-                    euca_strncpy(instance->ncnet.publicIp, ip, IP_BUFFER_SIZE);
-                    EUCA_FREE(ip);
-                }
-            }
-        }
+#undef BYTES_PER_SECTOR
+#undef MILLS_PER_SECOND
+}
 
-        if (!strncmp(instance->ncnet.privateIp, "0.0.0.0", IP_BUFFER_SIZE)) {
-            rc = mac2ip(nc_state.vnetconfig, instance->ncnet.privateMac, &ip);
-            if (!rc && ip) {
-                LOGINFO("[%s] discovered private IP %s for instance\n", instance->instanceId, ip);
-                euca_strncpy(instance->ncnet.privateIp, ip, IP_BUFFER_SIZE);
-                EUCA_FREE(ip);
+//!
+//! Collects the values the sensor subsystem used to get from the getstats.pl script for all
+//! active instances straight from the cgroups of their domains, the host's tap interfaces and
+//! /proc/diskstats, without a call into the hypervisor. Both the unified (v2) hierarchy and the
+//! v1 cpuacct and blkio ones are supported.
+//!
+//! @param[in,out] pstats stats array to append the values to
+//!
+//! @return EUCA_OK on success, EUCA_UNSUPPORTED_ERROR if the cgroups of the domains cannot be
+//!         found, in which case nothing is appended, or EUCA_ERROR on failure
+//!
+static int collect_cgroup_stats(getstat *** pstats)
+{
+    int rc = EUCA_OK;
+    int nactive = 0;
+    int nfound = 0;
+    int ndisks = 0;
+    int ncpu = 0;
+    int nblk = 0;
+    int ntaps = 0;
+    int nios = 0;
+    long long ts = 0;
+    unsigned long long val = 0;
+    boolean unified = FALSE;
+    char path[EUCA_MAX_PATH] = "";
+    ncInstance *instance = NULL;
+    ncDiskStat *disks = NULL;
+    ncCgroupDomain *cpu_domains = NULL;
+    ncCgroupDomain *blk_domains = NULL;
+    ncCgroupDomain *domain = NULL;
+    ncCgroupIo *ios = NULL;
+    ncTapStat *taps = NULL;
+    instancesSnapshot *snapshot = NULL;
+
+    // the sensor thread holds 'hyp_sem' and others take it under 'inst_sem', so only the snapshot is safe here
+    if ((snapshot = acquire_instances_snapshot()) == NULL)
+        return (EUCA_UNSUPPORTED_ERROR);
+
+    unified = (check_file(CGROUP_MOUNT_PATH "/cgroup.controllers") == 0);
+    if (unified) {
+        ncpu = find_cgroup_domains(CGROUP_MOUNT_PATH, &cpu_domains);
+    } else {
+        ncpu = find_cgroup_domains(CGROUP_MOUNT_PATH "/cpuacct", &cpu_domains);
+        nblk = find_cgroup_domains(CGROUP_MOUNT_PATH "/blkio", &blk_domains);
+    }
+
+    for (int i = 0; i < snapshot->instancesLen; i++) {
+        instance = snapshot->instances[i];
+        if ((instance->state != RUNNING) && (instance->state != BLOCKED) && (instance->state != PAUSED))
+            continue;
+        nactive++;
+        if (find_cgroup_domain(cpu_domains, ncpu, instance->instanceId))
+            nfound++;
+    }
+
+    if ((ncpu < 0) || ((nactive > 0) && (nfound == 0))) {
+        EUCA_FREE(cpu_domains);
+        EUCA_FREE(blk_domains);
+        release_instances_snapshot(snapshot);
+        return (EUCA_UNSUPPORTED_ERROR);
+    }
+
+    if ((ndisks = read_diskstats(&disks)) < 0)
+        ndisks = 0;
+    if ((ntaps = read_tapstats(&taps)) < 0)
+        ntaps = 0;
+    ts = time_ms();
+
+    for (int i = 0; (i < snapshot->instancesLen) && (rc == EUCA_OK); i++) {
+        instance = snapshot->instances[i];
+        if ((instance->state != RUNNING) && (instance->state != BLOCKED) && (instance->state != PAUSED))
+            continue;
+        if ((domain = find_cgroup_domain(cpu_domains, ncpu, instance->instanceId)) == NULL)
+            continue;
+
+        // microseconds (v2) or nanoseconds (v1) of CPU time used by the domain, reported in millis
+        if (unified) {
+            snprintf(path, sizeof(path), "%s/cpu.stat", domain->path);
+            if (read_stat_file(path, "usage_usec", &val))
+                rc |= getstat_append(pstats, instance->instanceId, ts, "CPUUtilization", SENSOR_SUMMATION, "default", (val / 1000.0));
+        } else {
+            snprintf(path, sizeof(path), "%s/cpuacct.usage", domain->path);
+            if (read_stat_file(path, NULL, &val))
+                rc |= getstat_append(pstats, instance->instanceId, ts, "CPUUtilization", SENSOR_SUMMATION, "default", (val / 1000000.0));
+        }
+
+        // what the guest sends is received by the tap, and the other way around
+        for (int j = 0; j < ntaps; j++) {
+            if ((strlen(instance->ncnet.privateMac) > 2) && !strcasecmp((taps[j].mac + 2), (instance->ncnet.privateMac + 2))) {
+                rc |= getstat_append(pstats, instance->instanceId, ts, "NetworkIn", SENSOR_SUMMATION, "total", taps[j].tx_bytes);
+                rc |= getstat_append(pstats, instance->instanceId, ts, "NetworkOut", SENSOR_SUMMATION, "total", taps[j].rx_bytes);
+                break;
             }
         }
-        // set guest power state
-        strncpy(instance->guestStateName, GUEST_STATE_POWERED_ON, CHAR_BUFFER_SIZE);
-    } else {
-        strncpy(instance->guestStateName, GUEST_STATE_POWERED_OFF, CHAR_BUFFER_SIZE);
+
+        nios = 0;
+        if (!unified)
+            domain = find_cgroup_domain(blk_domains, nblk, instance->instanceId);
+        if (domain && ((nios = read_cgroup_io(domain->path, unified, &ios)) < 0))
+            nios = 0;
+        rc |= collect_instance_disk_stats(pstats, instance, ts, disks, ndisks, ios, nios);
+        EUCA_FREE(ios);
     }
 
-    // persist state updates to disk
-    save_instance_struct(instance);
+    EUCA_FREE(taps);
+    EUCA_FREE(disks);
+    EUCA_FREE(cpu_domains);
+    EUCA_FREE(blk_domains);
+    release_instances_snapshot(snapshot);
+    return ((rc == EUCA_OK) ? EUCA_OK : EUCA_ERROR);
 }
 
 //!
-//! copying the linked list for use by Describe* requests
+//! Stats collector of the sensor subsystem: reads the counters of the instances from the
+//! cgroups of their domains and falls back to the libvirt bulk stats where those cannot be found
 //!
-void copy_instances(void)
+//! @param[in,out] pstats stats array to append the values to
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int collect_instance_stats(getstat *** pstats)
 {
-    ncInstance *instance = NULL;
-    ncInstance *src_instance = NULL;
-    ncInstance *dst_instance = NULL;
-    bunchOfInstances *head = NULL;
-    bunchOfInstances *container = NULL;
+    static boolean warned = FALSE;
+    int rc = EUCA_OK;
 
-    sem_p(inst_copy_sem);
-    {
-        // free the old linked list copy
-        for (head = global_instances_copy; head;) {
-            container = head;
-            instance = head->instance;
-            head = head->next;
-            EUCA_FREE(instance);
-            EUCA_FREE(container);
-        }
+    if ((rc = collect_cgroup_stats(pstats)) != EUCA_UNSUPPORTED_ERROR)
+        return ((rc == EUCA_OK) ? EUCA_OK : EUCA_ERROR);
 
-        global_instances_copy = NULL;
+    if (!warned) {
+        LOGINFO("cgroups of the domains not found under %s, collecting instance stats from the hypervisor\n", CGROUP_MOUNT_PATH);
+        warned = TRUE;
+    }
+#if LIBVIR_VERSION_NUMBER >= 1002008
+    return (collect_domain_stats(pstats));
+#else /* LIBVIR_VERSION_NUMBER >= 1002008 */
+    return (EUCA_ERROR);
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+}
 
-        // make a fresh copy
-        for (head = global_instances; head; head = head->next) {
-            src_instance = head->instance;
-            dst_instance = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance));
-            memcpy(dst_instance, src_instance, sizeof(ncInstance));
-            add_instance(&global_instances_copy, dst_instance);
+//!
+//! Runs the default libvirt event loop, which sends the keepalive pings on our hypervisor
+//! connections and runs the callbacks registered on them
+//!
+//! @param[in] ptr unused
+//!
+//! @return Always return NULL
+//!
+static void *libvirt_event_thread(void *ptr)
+{
+#if LIBVIR_VERSION_NUMBER >= 10000
+    for (;;) {
+        if (virEventRunDefaultImpl() < 0) {
+            LOGWARN("failed to run an iteration of the libvirt event loop\n");
+            sleep(1);
         }
     }
-    sem_v(inst_copy_sem);
+#endif /* LIBVIR_VERSION_NUMBER >= 10000 */
+    return (NULL);
 }
 
 //!
-//! helper that is used during initialization and by monitornig thread
+//! Starts the libvirt event loop, so that hypervisor connections can be kept open and checked
+//! with keepalive pings instead of being checked and reopened before every use. Must be called
+//! before the first connection is opened.
 //!
-static void update_log_params(void)
+//! @return EUCA_OK if keepalive can be used or EUCA_ERROR if connections will be checked and
+//!         reopened on every use, as with older versions of libvirt
+//!
+static int init_hypervisor_events(void)
 {
-    int log_level = 0;
-    int log_roll_number = 0;
-    long log_max_size_bytes = 0;
-    char *log_prefix = NULL;
-    char *log_facility = NULL;
+#if LIBVIR_VERSION_NUMBER >= 10000
+    pthread_t thread = { 0 };
 
-    // read log params from config file and update in-memory configuration
-    configReadLogParams(&log_level, &log_roll_number, &log_max_size_bytes, &log_prefix);
+    if (virEventRegisterDefaultImpl() != 0) {
+        LOGWARN("failed to register the libvirt event loop, hypervisor connections will be reopened on every use\n");
+        return (EUCA_ERROR);
+    }
+    if (pthread_create(&thread, NULL, libvirt_event_thread, NULL) != 0) {
+        LOGWARN("failed to start the libvirt event loop thread, hypervisor connections will be reopened on every use\n");
+        return (EUCA_ERROR);
+    }
+    pthread_detach(thread);
+    hyp_keepalive = TRUE;
+    return (EUCA_OK);
+#else /* LIBVIR_VERSION_NUMBER >= 10000 */
+    return (EUCA_ERROR);
+#endif /* LIBVIR_VERSION_NUMBER >= 10000 */
+}
 
-    // reconfigure the logging subsystem to use the new values, if any
-    log_params_set(log_level, log_roll_number, log_max_size_bytes);
-    log_prefix_set(log_prefix);
-    EUCA_FREE(log_prefix);
+//!
+//! Invoked by libvirt, from the event loop, when it closes a connection on its own, e.g.,
+//! because libvirtd stopped answering keepalive pings or went away
+//!
+//! @param[in] conn the connection that was closed
+//! @param[in] reason VIR_CONNECT_CLOSE_REASON_* code
+//! @param[in] opaque the hypervisorConn structure of the connection
+//!
+static void libvirt_close_callback(virConnectPtr conn, int reason, void *opaque)
+{
+    hypervisorConn *hc = ((hypervisorConn *) opaque);
 
-    if ((log_facility = configFileValue("LOGFACILITY")) != NULL) {
-        if (strlen(log_facility) > 0) {
-            log_facility_set(log_facility, "nc");
+    LOGWARN("libvirt closed the hypervisor %s connection (reason=%d), it will be reopened\n", (hc->query ? "query" : "operations"), reason);
+    hc->closed = TRUE;
+}
+
+//!
+//! Invoked by libvirt, from the event loop, when a domain is started, stopped, suspended,
+//! resumed, defined or undefined. Only records the name of the domain and wakes up the
+//! monitoring thread, which refreshes the instance.
+//!
+//! @param[in] conn the query connection
+//! @param[in] dom the domain the event is about
+//! @param[in] event VIR_DOMAIN_EVENT_* code
+//! @param[in] detail event-specific detail code
+//! @param[in] opaque unused
+//!
+//! @return Always return 0
+//!
+static int libvirt_lifecycle_callback(virConnectPtr conn, virDomainPtr dom, int event, int detail, void *opaque)
+{
+    int i = 0;
+    const char *name = virDomainGetName(dom);
+
+    LOGTRACE("[%s] domain event %d (detail=%d)\n", SP(name), event, detail);
+    if (name == NULL)
+        return (0);
+
+    pthread_mutex_lock(&domain_events_mutex);
+    for (i = 0; (i < domain_events_len) && strcmp(domain_events[i], name); i++) ;
+    if (i == domain_events_len) {
+        if (domain_events_len < MAXINSTANCES_PER_NC) {
+            euca_strncpy(domain_events[domain_events_len++], name, CHAR_BUFFER_SIZE);
+        } else {
+            domain_events_overflow = TRUE;
         }
-        EUCA_FREE(log_facility);
     }
+    pthread_cond_signal(&domain_events_cond);
+    pthread_mutex_unlock(&domain_events_mutex);
+    return (0);
 }
 
 //!
-//! helper that is used during initialization and by monitornig thread
+//! Tells whether domain lifecycle events are being delivered, which is the case while the
+//! query connection is alive and subscribed to them
 //!
-static void update_ebs_params(void)
+//! @return TRUE if state changes of settled instances are learned from events or FALSE if
+//!         they need to be polled
+//!
+static boolean domain_events_live(void)
 {
-    char * ceph_user = getConfString(nc_state.configFiles, 2, CONFIG_NC_CEPH_USER);
-    char * ceph_keys = getConfString(nc_state.configFiles, 2, CONFIG_NC_CEPH_KEYS);
-    char * ceph_conf = getConfString(nc_state.configFiles, 2, CONFIG_NC_CEPH_CONF);
-    init_iscsi(nc_state.home,
-               (ceph_user==NULL)?(DEFAULT_CEPH_USER):(ceph_user),
-               (ceph_keys==NULL)?(DEFAULT_CEPH_KEYRING):(ceph_keys),
-               (ceph_conf==NULL)?(DEFAULT_CEPH_CONF):(ceph_conf));
-    EUCA_FREE(ceph_user);
-    EUCA_FREE(ceph_keys);
-    EUCA_FREE(ceph_conf);
+    return ((hyp_keepalive && (domain_events_callback >= 0) && !hyp_query_conn.closed) ? TRUE : FALSE);
 }
 
 //!
-//! This defines the NC monitoring thread
+//! Closes and reopens a hypervisor connection. Runs in its own thread, which we will try to
+//! wake up with SIGUSR1 if it blocks for too long.
 //!
-//! @param[in] arg a transparent pointer to the global NC state structure
+//! @param[in] ptr the hypervisorConn structure of the connection
 //!
 //! @return Always return NULL
 //!
-void *monitoring_thread(void *arg)
+static void *libvirt_thread(void *ptr)
 {
-#define EUCANETD_PID_FILE         "%s/var/run/eucalyptus/eucanetd.pid"
-#define EUCANETD_SERVICE_NAME     "eucanetd"
+    int rc = 0;
+    sigset_t mask = { {0} };
+    hypervisorConn *hc = ((hypervisorConn *) ptr);
 
-    int i = 0;
-    int tmpint = 0;
-    int left = 0;
-    int cleaned_up = 0;
-    int destroy_files = 0;
-    u32 ipHex = 0;
-    char *psPid = NULL;
-    char sPidFile[EUCA_MAX_PATH] = "";
-    char nfile[EUCA_MAX_PATH] = "";
-    char nfilefinal[EUCA_MAX_PATH] = "";
-    char URL[EUCA_MAX_PATH] = "";
-    char ccHost[EUCA_MAX_PATH] = "";
-    char clcHost[EUCA_MAX_PATH] = "";
-    char tmpbuf[EUCA_MAX_PATH] = "";
-    long long iteration = 0;
-    long long work_fs_size_mb = 0;
-    long long work_fs_avail_mb = 0;
-    long long cache_fs_size_mb = 0;
-    long long cache_fs_avail_mb = 0;
-    FILE *FP = NULL;
-    time_t now = 0;
-    struct nc_state_t *nc = NULL;
-    bunchOfInstances *head = NULL;
-    bunchOfInstances *vnhead = NULL;
-    ncInstance *instance = NULL;
-    ncInstance *vninstance = NULL;
+    // allow SIGUSR1 signal to be delivered to this thread and its children
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
 
-    LOGINFO("spawning monitoring thread\n");
-    if (arg == NULL) {
-        LOGFATAL("internal error (NULL parameter to monitoring_thread)\n");
-        return NULL;
+    if (hc->conn) {
+#if LIBVIR_VERSION_NUMBER >= 10000
+        // so that a late callback on the old connection does not flag the new one
+        if (hyp_keepalive) {
+            if (hc->query && (domain_events_callback >= 0)) {
+                virConnectDomainEventDeregisterAny(hc->conn, domain_events_callback);
+                domain_events_callback = -1;
+            }
+            virConnectUnregisterCloseCallback(hc->conn, libvirt_close_callback);
+        }
+#endif /* LIBVIR_VERSION_NUMBER >= 10000 */
+        if ((rc = virConnectClose(hc->conn)) != 0) {
+            LOGDEBUG("refcount on close was non-zero: %d\n", rc);
+        }
+    }
+    hc->closed = FALSE;
+    hc->conn = virConnectOpen(nc_state.uri);
+#if LIBVIR_VERSION_NUMBER >= 10000
+    if (hc->conn && hyp_keepalive) {
+        if (virConnectSetKeepAlive(hc->conn, LIBVIRT_KEEPALIVE_INTERVAL_SEC, LIBVIRT_KEEPALIVE_COUNT) != 0) {
+            LOGDEBUG("keepalive not supported on hypervisor connection, relying on close events\n");
+        }
+        if (virConnectRegisterCloseCallback(hc->conn, libvirt_close_callback, hc, NULL) != 0) {
+            LOGWARN("failed to register close callback on hypervisor connection\n");
+        }
+        // with the event loop, instance state changes are learned from domain events
+        if (hc->query) {
+            domain_events_callback = virConnectDomainEventRegisterAny(hc->conn, NULL, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                                      VIR_DOMAIN_EVENT_CALLBACK(libvirt_lifecycle_callback), NULL, NULL);
+            if (domain_events_callback < 0) {
+                LOGWARN("failed to subscribe to domain events, the state of instances will be polled\n");
+            }
+        }
     }
+#endif /* LIBVIR_VERSION_NUMBER >= 10000 */
+    if (!hc->query)
+        nc_state.conn = hc->conn;
+    return (NULL);
+}
 
-    nc = ((struct nc_state_t *)arg);
+//!
+//! Makes sure a hypervisor connection is usable. A connection that libvirt still considers
+//! alive is used as is: keepalive pings from the event loop make libvirt close connections to
+//! a hung or restarted libvirtd, which we learn through the close callback. Otherwise, and on
+//! every call when there is no event loop, the connection is checked and reopened.
+//!
+//! @param[in] hc the connection to check, whose lock the caller holds
+//!
+//! @return EUCA_OK if the connection can be used or EUCA_ERROR otherwise
+//!
+static int check_hypervisor_conn(hypervisorConn * hc)
+{
+    int rc = 0;
+    int status = 0;
+    pid_t cpid = 0;
+    pthread_t thread = { 0 };
+    boolean bail = FALSE;
+    struct timespec ts = { 0 };
+    virConnectPtr tmp_conn = NULL;
 
-    for (iteration = 0; TRUE; iteration++) {
-        now = time(NULL);
+#if LIBVIR_VERSION_NUMBER >= 10000
+    if (hyp_keepalive && hc->conn && !hc->closed && (virConnectIsAlive(hc->conn) == 1))
+        return (EUCA_OK);
+#endif /* LIBVIR_VERSION_NUMBER >= 10000 */
 
-        // EUCA-10056 we need to check if EUCANETD is running when in EDGE of VPC mode
-        if (!strcmp(nc_state.vnetconfig->mode, NETMODE_EDGE)) {
-            snprintf(sPidFile, EUCA_MAX_PATH, EUCANETD_PID_FILE, nc_state.home);
-            if ((psPid = file2str(sPidFile)) != NULL) {
-                // Is the
-                if (euca_is_running(atoi(psPid), EUCANETD_SERVICE_NAME)) {
-                    if (nc_state.isEucanetdEnabled == FALSE)
-                        LOGDEBUG("Service %s detected and running.\n", EUCANETD_SERVICE_NAME);
-                    nc_state.isEucanetdEnabled = TRUE;
-                } else if (nc_state.isEucanetdEnabled) {
-                    // EUCANETD isn't running... Throw a fault for the user to correct
-                    LOGERROR("Service %s not running (even if PID file is detected).\n", EUCANETD_SERVICE_NAME);
-                    nc_state.isEucanetdEnabled = FALSE;
-                    log_eucafault("1008", "daemon", EUCANETD_SERVICE_NAME, NULL);
-                }
-                EUCA_FREE(psPid);
-            } else if (nc_state.isEucanetdEnabled) {
-                // EUCANETD isn't running... Throw a fault for the user to correct
-                LOGERROR("Service %s not running.\n", EUCANETD_SERVICE_NAME);
-                nc_state.isEucanetdEnabled = FALSE;
-                log_eucafault("1008", "daemon", EUCANETD_SERVICE_NAME, NULL);
-            }
+    if (call_hooks(NC_EVENT_PRE_HYP_CHECK, nc_state.home)) {
+        LOGFATAL("hooks prevented check on the hypervisor\n");
+        return (EUCA_ERROR);
+    }
+    // Fork off a process just to open and immediately close a libvirt connection.
+    // The purpose is to try to identify periods when open or close calls block indefinitely.
+    // Success in the child process does not guarantee success in the parent process, but
+    // hopefully it will flag certain bad conditions and will allow the parent to avoid them.
+
+    if ((cpid = fork()) < 0) {         // fork error
+        LOGERROR("failed to fork to check hypervisor connection\n");
+        bail = TRUE;                   // we are in big trouble if we cannot fork
+    } else if (cpid == 0) {            // child process - checks on the connection
+        if ((tmp_conn = virConnectOpen(nc_state.uri)) == NULL)
+            exit(1);
+        virConnectClose(tmp_conn);
+        exit(0);
+    } else {                           // parent process - waits for the child, kills it if necessary
+        if ((rc = timewait(cpid, &status, LIBVIRT_TIMEOUT_SEC)) < 0) {
+            LOGERROR("failed to wait for forked process: %s\n", strerror(errno));
+            bail = TRUE;
+        } else if (rc == 0) {
+            LOGERROR("timed out waiting for hypervisor checker pid=%d\n", cpid);
+            bail = TRUE;
+        } else if (WEXITSTATUS(status) != 0) {
+            LOGERROR("child process failed to connect to hypervisor\n");
+            bail = TRUE;
         }
+        // terminate the child, if any
+        killwait(cpid);
+    }
 
-        sem_p(inst_sem);
+    if (bail) {
+        return (EUCA_ERROR);           // better fail the operation than block the whole NC
+    }
+    LOGTRACE("process check for libvirt succeeded\n");
 
-        snprintf(nfile, EUCA_MAX_PATH, EUCALYPTUS_LOG_DIR "/local-net.stage", nc_state.home);
-        snprintf(nfilefinal, EUCA_MAX_PATH, EUCALYPTUS_LOG_DIR "/local-net", nc_state.home);
-        if ((FP = fopen(nfile, "w")) == NULL) {
-            LOGWARN("could not open file %s for writing\n", nfile);
-        } else {
-            // print out latest CC and CLC IP addr to the local-net file
-            URL[0] = ccHost[0] = clcHost[0] = '\0';
+    // At this point, the check for libvirt done in a separate process was
+    // successful, so we proceed to close and reopen the connection in a
+    // separate thread, which we will try to wake up with SIGUSR1 if it
+    // blocks for too long (as a last-resource effort). Without keepalive,
+    // we reset the connection on every use because libvirt operations have
+    // a tendency to block indefinitely if we do not do this.
 
-            for (i = 0; i < nc_state.servicesLen; i++) {
-                if (!strcmp(nc_state.services[i].type, "cluster")) {
-                    if (nc_state.services[i].urisLen > 0) {
-                        memcpy(URL, nc_state.services[i].uris[0], 512);
-                        if (strlen(URL)) {
-                            if (tokenize_uri(URL, tmpbuf, ccHost, &tmpint, tmpbuf)) {
-                                snprintf(ccHost, EUCA_MAX_PATH, "0.0.0.0");
-                            }
-                        }
+    if (pthread_create(&thread, NULL, libvirt_thread, ((void *)hc)) != 0) {
+        LOGERROR("failed to create the libvirt refreshing thread\n");
+        bail = TRUE;
+    } else {
+        for (;;) {
+            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+                LOGERROR("failed to obtain time\n");
+                bail = TRUE;
+                break;
+            }
+
+            ts.tv_sec += LIBVIRT_TIMEOUT_SEC;
+            if ((rc = pthread_timedjoin_np(thread, NULL, &ts)) == 0)
+                break;                 // all is well
+
+            if (rc != ETIMEDOUT) {     // error other than timeout
+                LOGERROR("failed to wait for libvirt refreshing thread (rc=%d)\n", rc);
+                bail = TRUE;
+                break;
+            }
+
+            LOGERROR("timed out on libvirt refreshing thread\n");
+            pthread_kill(thread, SIGUSR1);
+            sleep(1);
+        }
+    }
+
+    if (bail) {
+        return (EUCA_ERROR);
+    }
+    LOGTRACE("thread check for libvirt succeeded\n");
+
+    if (hc->conn == NULL) {
+        LOGERROR("failed to connect to %s\n", nc_state.uri);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Acquires the hypervisor connection for domain operations, which are serialized, checking
+//! the connection and reopening it if necessary.
+//!
+//! @return a pointer to the hypervisor connection structure or NULL if we failed.
+//!
+//! @see unlock_hypervisor_conn()
+//!
+virConnectPtr lock_hypervisor_conn()
+{
+    // Acquire our hypervisor semaphore
+    EUCA_PROBE(hyp__lock__wait);
+    sem_p(hyp_sem);
+
+    if (check_hypervisor_conn(&hyp_conn) != EUCA_OK) {
+        sem_v(hyp_sem);
+        EUCA_PROBE1(hyp__lock__acquired, FALSE);
+        return (NULL);
+    }
+    EUCA_PROBE1(hyp__lock__acquired, TRUE);
+    return (hyp_conn.conn);
+}
+
+//!
+//! Closes the connection with the hypervisor
+//!
+void unlock_hypervisor_conn()
+{
+    sem_v(hyp_sem);
+    EUCA_PROBE(hyp__lock__released);
+}
+
+//!
+//! Acquires the shared hypervisor connection for queries (lookups, domain info and XML),
+//! which up to LIBVIRT_QUERY_CALLERS threads may use at once, without waiting for domain
+//! operations holding hyp_sem. Callers must not create domains on this connection.
+//!
+//! @return a reference to the query connection or NULL if we failed.
+//!
+//! @see unlock_hypervisor_query_conn()
+//!
+virConnectPtr lock_hypervisor_query_conn(void)
+{
+    virConnectPtr conn = NULL;
+
+    sem_p(hyp_query_sem);
+    pthread_mutex_lock(&hyp_query_mutex);
+    if (check_hypervisor_conn(&hyp_query_conn) == EUCA_OK) {
+        // the reference keeps the connection valid for us even if another caller reopens it
+        conn = hyp_query_conn.conn;
+        virConnectRef(conn);
+    }
+    pthread_mutex_unlock(&hyp_query_mutex);
+
+    if (conn == NULL)
+        sem_v(hyp_query_sem);
+    return (conn);
+}
+
+//!
+//! Releases the query connection obtained from lock_hypervisor_query_conn()
+//!
+//! @param[in] conn the connection returned by lock_hypervisor_query_conn()
+//!
+void unlock_hypervisor_query_conn(virConnectPtr conn)
+{
+    virConnectClose(conn);
+    sem_v(hyp_query_sem);
+}
+
+//!
+//! Instance state state machine.
+//!
+//! @param[in] instance a pointer to the instance to modify
+//! @param[in] state the new instance state
+//!
+void change_state(ncInstance * instance, instance_states state)
+{
+    int old_state = instance->state;
+
+    instance->state = ((int)state);
+    switch (state) {                   /* mapping from NC's internal states into external ones */
+    case STAGING:
+    case CANCELED:
+        instance->stateCode = PENDING;
+        break;
+    case BOOTING:
+    case RUNNING:
+    case BLOCKED:
+    case PAUSED:
+        instance->stateCode = EXTANT;
+        instance->retries = LIBVIRT_QUERY_RETRIES;
+        break;
+    case CRASHED:
+    case BUNDLING_SHUTDOWN:
+    case BUNDLING_SHUTOFF:
+    case CREATEIMAGE_SHUTDOWN:
+    case CREATEIMAGE_SHUTOFF:
+    case SHUTDOWN:
+    case SHUTOFF:
+        if (instance->stateCode != EXTANT) {
+            instance->stateCode = PENDING;
+        }
+        instance->retries = LIBVIRT_QUERY_RETRIES;
+        break;
+    case TEARDOWN:
+        instance->stateCode = TEARDOWN;
+        break;
+    default:
+        LOGERROR("[%s] unexpected state (%d)\n", instance->instanceId, instance->state);
+        return;
+    }
+
+    euca_strncpy(instance->stateName, instance_state_names[instance->stateCode], CHAR_BUFFER_SIZE);
+    if (old_state != state) {
+        LOGDEBUG("[%s] state change for instance: %s -> %s (%s)\n",
+                 instance->instanceId, instance_state_names[old_state], instance_state_names[instance->state], instance_state_names[instance->stateCode]);
+    }
+}
+
+//!
+//! waits indefinitely until a state transition takes place  (timeouts are implemented in the
+//! monitoring thread) and returns 0 if from_state->to_state transition takes place and 1 otherwise
+//!
+//! @param[in] instance a pointer to the instance we're monitoring
+//! @param[in] from_state the starting state of the transition
+//! @param[in] to_state the ending state of the transition
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int wait_state_transition(ncInstance * instance, instance_states from_state, instance_states to_state)
+{
+    instance_states current_state = NO_STATE;
+
+    while (1) {
+        current_state = instance->state;
+        if (current_state == to_state)
+            return (EUCA_OK);
+
+        if (current_state != from_state)
+            return (EUCA_ERROR);
+
+        // no point in checking more frequently
+        sleep(MONITORING_PERIOD);
+    }
+    return (EUCA_ERROR);
+}
+
+//!
+//! Refresh instance information.
+//!
+//! (This is called while holding inst_sem.)
+//!
+//! @param[in] nc a pointer to the global NC state structure.
+//! @param[in] instance a pointer to the instance being refreshed
+//!
+static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
+{
+    int error = 0;
+    int rc = 0;
+    char *ip = NULL;
+    virDomainInfo info = { 0 };
+    instance_states new_state = NO_STATE;
+    instance_states old_state = instance->state;
+
+    // no need to bug for domains without state on Hypervisor
+    if (old_state == TEARDOWN || old_state == STAGING || old_state == BUNDLING_SHUTOFF || old_state == CREATEIMAGE_SHUTOFF)
+        return;
+
+    {                                  // all this is done with a reference to the query connection
+        virConnectPtr conn = lock_hypervisor_query_conn();
+        if (conn == NULL)
+            return;
+
+        virDomainPtr dom = virDomainLookupByName(conn, instance->instanceId);
+
+        if (dom == NULL) {             // hypervisor doesn't know about it
+            if (old_state == BUNDLING_SHUTDOWN) {
+                LOGINFO("[%s] detected disappearance of bundled domain\n", instance->instanceId);
+                change_state(instance, BUNDLING_SHUTOFF);
+            } else if (old_state == CREATEIMAGE_SHUTDOWN) {
+                LOGINFO("[%s] detected disappearance of createImage domain\n", instance->instanceId);
+                change_state(instance, CREATEIMAGE_SHUTOFF);
+            } else if (old_state == RUNNING || old_state == BLOCKED || old_state == PAUSED || old_state == SHUTDOWN) {
+                // If we just finished migration, then this is normal.
+                //
+                // Could this be a bad assumption if the
+                // virDomainLookupByName() call above returns NULL for
+                // some transient reason rather than because hypervisor
+                // doesn't know of the domain any more?
+                if (is_migration_src(instance)) {
+                    if (instance->migration_state == MIGRATION_IN_PROGRESS) {
+                        // This usually occurs when there has been some
+                        // glitch in the migration: an i/o error or
+                        // reset connction.  When that happens, we do
+                        // *not* want to shut off the instance!
+                        //
+                        // It can also happen absent an anomaly, such as
+                        // when refresh_instance_info() is called right
+                        // as the migration is completing (there's a race).
+                        LOGDEBUG("[%s] possible migration anomaly, not yet assuming completion\n", instance->instanceId);
+                        unlock_hypervisor_query_conn(conn);
+                        return;
                     }
-                } else if (!strcmp(nc_state.services[i].type, "eucalyptus")) {
-                    if (nc_state.services[i].urisLen > 0) {
-                        memcpy(URL, nc_state.services[i].uris[0], 512);
-                        if (strlen(URL)) {
-                            if (tokenize_uri(URL, tmpbuf, clcHost, &tmpint, tmpbuf)) {
-                                snprintf(clcHost, EUCA_MAX_PATH, "0.0.0.0");
-                            }
+                    LOGINFO("[%s] migration completed (state='%s'), cleaning up\n", instance->instanceId, migration_state_names[instance->migration_state]);
+                    change_state(instance, SHUTOFF);
+                    unlock_hypervisor_query_conn(conn);
+                    return;
+                }
+                // most likely the user has shut it down from the inside
+                if (instance->stop_requested) {
+                    LOGDEBUG("[%s] ignoring domain in stopped state\n", instance->instanceId);
+                } else if (instance->terminationRequestedTime) {
+                    LOGDEBUG("[%s] hypervisor not finding the terminating domain\n", instance->instanceId);
+                } else if (instance->retries) {
+                    LOGWARN("[%s] hypervisor failed to find domain, will retry %d more time(s)\n", instance->instanceId, instance->retries);
+                    instance->retries--;
+                } else {
+                    LOGWARN("[%s] hypervisor failed to find domain, assuming it was shut off\n", instance->instanceId);
+                    change_state(instance, SHUTOFF);
+                }
+            }
+            // else 'old_state' stays in SHUTFOFF, BOOTING, CANCELED, or CRASHED
+
+            // set guest power state
+            strncpy(instance->guestStateName, GUEST_STATE_POWERED_OFF, CHAR_BUFFER_SIZE);
+
+            // persist state updates to disk
+            save_instance_struct(instance);
+
+            unlock_hypervisor_query_conn(conn);
+            return;
+        }
+
+        error = virDomainGetInfo(dom, &info);
+        if ((error < 0) || (info.state == VIR_DOMAIN_NOSTATE)) {
+            LOGWARN("[%s] failed to get information for domain\n", instance->instanceId);
+            // what to do? hopefully we'll find out more later
+            virDomainFree(dom);
+            unlock_hypervisor_query_conn(conn);
+            return;
+        }
+
+        new_state = info.state;
+        switch (old_state) {
+        case BOOTING:
+        case RUNNING:
+        case BLOCKED:
+        case PAUSED:
+            // migration-related logic
+            if (is_migration_dst(instance)) {
+                if (old_state == BOOTING && new_state == PAUSED) {
+                    incoming_migrations_in_progress++;
+                    LOGINFO("[%s] incoming (%s < %s) migration in progress (1 of %d)\n", instance->instanceId, instance->migration_dst, instance->migration_src,
+                            incoming_migrations_in_progress);
+                    instance->migration_state = MIGRATION_IN_PROGRESS;
+                    LOGDEBUG("[%s] incoming (%s < %s) migration_state set to '%s'\n", instance->instanceId,
+                             instance->migration_dst, instance->migration_src, migration_state_names[instance->migration_state]);
+
+                } else if ((old_state == BOOTING || old_state == PAUSED)
+                           && (new_state == RUNNING || new_state == BLOCKED)) {
+                    LOGINFO("[%s] completing incoming (%s < %s) migration...\n", instance->instanceId, instance->migration_dst, instance->migration_src);
+                    instance->migration_state = NOT_MIGRATING;  // done!
+                    bzero(instance->migration_src, HOSTNAME_SIZE);
+                    bzero(instance->migration_dst, HOSTNAME_SIZE);
+                    bzero(instance->migration_credentials, CREDENTIAL_SIZE);
+                    instance->migrationTime = 0;
+                    save_instance_struct(instance);
+                    // copy_intances is called upon return in monitoring_thread().
+                    incoming_migrations_in_progress--;
+                    LOGINFO("[%s] incoming migration complete (%d other incoming migration[s] actively in progress)\n", instance->instanceId, incoming_migrations_in_progress);
+                    // If no remaining incoming or pending migrations, deauthorize all clients.
+                    // TO-DO: Consolidate with similar sequence in handlers_kvm.c into a utility function?
+                    if (!incoming_migrations_in_progress) {
+                        int incoming_migrations_pending = 0;
+                        int incoming_migrations_counted = 0;
+                        LOGINFO("no remaining active incoming migrations -- checking to see if there are any pending migrations\n");
+                        bunchOfInstances *head = NULL;
+                        for (head = global_instances; head; head = head->next) {
+                            if ((head->instance->migration_state == MIGRATION_PREPARING) || (head->instance->migration_state == MIGRATION_READY)) {
+                                LOGINFO("[%s] is pending migration, migration_state='%s', deferring deauthorization of migration keys\n", head->instance->instanceId,
+                                        migration_state_names[head->instance->migration_state]);
+                                incoming_migrations_pending++;
+                            }
+                            // Belt and suspenders...
+                            if ((head->instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, head->instance->migration_dst)) {
+                                LOGWARN("[%s] Possible internal bug detected: instance migration_state='%s', but incoming_migrations_in_progress=%d\n", head->instance->instanceId,
+                                        migration_state_names[head->instance->migration_state], incoming_migrations_in_progress);
+                                incoming_migrations_counted++;
+                            }
+                        }
+                        if (incoming_migrations_counted != incoming_migrations_in_progress) {
+                            LOGWARN("Possible internal bug detected: incoming_migrations_in_progress=%d, but %d incoming migrations counted\n", incoming_migrations_in_progress,
+                                    incoming_migrations_counted);
+                        }
+                        if (!incoming_migrations_pending) {
+                            LOGINFO("no remaining incoming or pending migrations\n");
+                            deauthorize_migration_keys();
+                        }
+                    } else {
+                        // Verify that our count of incoming_migrations_in_progress matches our version of reality.
+                        bunchOfInstances *head = NULL;
+                        int incoming_migrations_counted = 0;
+                        for (head = global_instances; head; head = head->next) {
+                            if ((head->instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, head->instance->migration_dst)) {
+                                incoming_migrations_counted++;
+                            }
+                        }
+                        if (incoming_migrations_counted != incoming_migrations_in_progress) {
+                            LOGWARN("Possible internal bug detected: incoming_migrations_in_progress=%d, but %d incoming migrations counted\n", incoming_migrations_in_progress,
+                                    incoming_migrations_counted);
+                        }
+                    }
+                } else if (new_state == SHUTOFF || new_state == SHUTDOWN) {
+                    // this is normal at the beginning of incoming migration, before a domain is created in PAUSED state
+                    break;
+                }
+            }
+
+            if (new_state == SHUTOFF || new_state == SHUTDOWN || new_state == CRASHED) {
+                LOGWARN("[%s] hypervisor reported previously running domain as %s\n", instance->instanceId, instance_state_names[new_state]);
+            }
+            // change to state, whatever it happens to be
+            change_state(instance, new_state);
+            break;
+        case SHUTDOWN:
+        case SHUTOFF:
+        case CRASHED:
+            if (new_state == RUNNING || new_state == BLOCKED || new_state == PAUSED) {
+                // cannot go back!
+                LOGWARN("[%s] detected prodigal domain, terminating it\n", instance->instanceId);
+                virDomainDestroy(dom);
+            } else {
+                change_state(instance, new_state);
+            }
+            break;
+        case BUNDLING_SHUTDOWN:
+        case CREATEIMAGE_SHUTDOWN:
+            LOGDEBUG("[%s] hypervisor state for bundle/createImage domain is %s\n", instance->instanceId, instance_state_names[new_state]);
+            break;
+        default:
+            LOGERROR("[%s] unexpected state (%d) in refresh\n", instance->instanceId, old_state);
+        }
+
+        virDomainFree(dom);
+        unlock_hypervisor_query_conn(conn);
+    }
+
+    // if instance is running, try to find out its IP address
+    if (instance->state == RUNNING || instance->state == BLOCKED || instance->state == PAUSED) {
+        ip = NULL;
+
+        if (!strncmp(instance->ncnet.publicIp, "0.0.0.0", IP_BUFFER_SIZE)) {
+            if (!strcmp(nc_state.vnetconfig->mode, "SYSTEM") || !strcmp(nc_state.vnetconfig->mode, "STATIC")) {
+                rc = mac2ip(nc_state.vnetconfig, instance->ncnet.privateMac, &ip);
+                if (!rc && ip) {
+                    LOGINFO("[%s] discovered public IP %s for instance\n", instance->instanceId, ip);
+                    euca_strncpy(instance->ncnet.publicIp, ip, IP_BUFFER_SIZE);
+                    EUCA_FREE(ip);
+                }
+            }
+        }
+
+        if (!strncmp(instance->ncnet.privateIp, "0.0.0.0", IP_BUFFER_SIZE)) {
+            rc = mac2ip(nc_state.vnetconfig, instance->ncnet.privateMac, &ip);
+            if (!rc && ip) {
+                LOGINFO("[%s] discovered private IP %s for instance\n", instance->instanceId, ip);
+                euca_strncpy(instance->ncnet.privateIp, ip, IP_BUFFER_SIZE);
+                EUCA_FREE(ip);
+            }
+        }
+        // set guest power state
+        strncpy(instance->guestStateName, GUEST_STATE_POWERED_ON, CHAR_BUFFER_SIZE);
+    } else {
+        strncpy(instance->guestStateName, GUEST_STATE_POWERED_OFF, CHAR_BUFFER_SIZE);
+    }
+
+    // persist state updates to disk
+    save_instance_struct(instance);
+}
+
+//!
+//! Tells whether an instance differs from its copy in a snapshot, ignoring the generation,
+//! which is only set on copies
+//!
+//! @param[in] copy a copy from a snapshot
+//! @param[in] instance the instance from global_instances
+//!
+//! @return TRUE if the copy is out of date or FALSE otherwise
+//!
+static boolean instance_copy_differs(const ncInstance * copy, const ncInstance * instance)
+{
+    size_t off = offsetof(ncInstance, generation);
+    size_t end = off + sizeof(copy->generation);
+
+    if (memcmp(copy, instance, off) || memcmp(((const char *)copy) + end, ((const char *)instance) + end, sizeof(ncInstance) - end))
+        return (TRUE);
+    return (FALSE);
+}
+
+//!
+//! Adds up NC disk usage for an instance
+//!
+//! @param[in] vm the parameters of the instance
+//!
+//! @return the disk space, in GB, the instance takes up on the NC
+//!
+static long long get_disk_use_gb(const virtualMachine * vm)
+{
+    long long disk_use_bytes = 0L;
+
+    for (int i = 0; i < EUCA_MAX_VBRS && i < vm->virtualBootRecordLen; i++) {
+        const virtualBootRecord *vbr = &(vm->virtualBootRecord[i]);
+        if (vbr->type != NC_RESOURCE_EBS && // EBS volumes do not count
+            vbr->type != NC_RESOURCE_KERNEL && // EKI doesn't count, though it maybe should
+            vbr->type != NC_RESOURCE_RAMDISK && // ERI doesn't count, though it maybe should
+            vbr->type != NC_RESOURCE_BOOT) { // boot sector is too small to be worth counting
+            disk_use_bytes += vbr->sizeBytes;
+        }
+    }
+
+    return disk_use_bytes/(1024*1024*1024);
+}
+
+//!
+//! Publishes a new snapshot of global_instances for use by Describe* requests, which read it
+//! without holding inst_sem and without copying it. Instances that have not changed since
+//! the previous snapshot are shared with it, so only new or modified instances are copied.
+//!
+//! Instances that are new or differ from their previous copy are stamped
+//! with a new value of the instance generation counter, which lets
+//! DescribeInstances return only the instances that changed since a
+//! generation the caller has already seen.
+//!
+//! The snapshot also carries the resources taken up by its instances, so
+//! that DescribeResource does not have to add them up on every call. The
+//! disk use of a copy is computed once, when the copy is made.
+//!
+//! (This is called while holding inst_sem.)
+//!
+void copy_instances(void)
+{
+    int i = 0;
+    int j = 0;
+    int total = 0;
+    boolean changed = FALSE;
+    boolean announce = FALSE;
+    long long generation = 0;
+    ncInstance *src_instance = NULL;
+    ncInstance *old_instance = NULL;
+    sharedInstance *dst_instance = NULL;
+    bunchOfInstances *head = NULL;
+    instancesSnapshot *old_snapshot = NULL;
+    instancesSnapshot *new_snapshot = NULL;
+
+    for (head = global_instances; head; head = head->next)
+        total++;
+
+    if (((new_snapshot = EUCA_ZALLOC(1, sizeof(instancesSnapshot))) == NULL)
+        || ((total > 0) && ((new_snapshot->instances = EUCA_ZALLOC(total, sizeof(ncInstance *))) == NULL))) {
+        LOGERROR("out of memory, instance snapshot not updated\n");
+        EUCA_FREE(new_snapshot);
+        return;
+    }
+    new_snapshot->refs = 1;
+
+    sem_p(inst_copy_sem);
+    {
+        // seed the counter with the start time, so generations handed out
+        // before an NC restart are never mistaken for current ones
+        if (instances_generation == 0)
+            instances_generation = time_usec();
+
+        old_snapshot = instances_snapshot;
+        for (i = 0, head = global_instances; head; head = head->next) {
+            src_instance = head->instance;
+
+            // instances tend to keep their position in the list, so check the same slot first
+            old_instance = NULL;
+            if (old_snapshot) {
+                if ((i < old_snapshot->instancesLen) && !strcmp(old_snapshot->instances[i]->instanceId, src_instance->instanceId)) {
+                    old_instance = old_snapshot->instances[i];
+                } else {
+                    for (j = 0; (j < old_snapshot->instancesLen) && (old_instance == NULL); j++) {
+                        if (!strcmp(old_snapshot->instances[j]->instanceId, src_instance->instanceId))
+                            old_instance = old_snapshot->instances[j];
+                    }
+                }
+            }
+
+            if (old_instance && !instance_copy_differs(old_instance, src_instance)) {
+                dst_instance = (sharedInstance *) old_instance;
+                dst_instance->refs++;
+                new_snapshot->instances[i++] = old_instance;
+                add_resource_use(new_snapshot, dst_instance);
+                continue;
+            }
+
+            // the CC wants to hear about instances that come, go or change state, not about every change
+            if (!old_instance || (old_instance->state != src_instance->state) || (old_instance->migration_state != src_instance->migration_state))
+                announce = TRUE;
+
+            if ((dst_instance = EUCA_SLAB_ALLOC(&shared_instance_slab)) == NULL) {
+                LOGERROR("[%s] out of memory, instance left out of snapshot\n", src_instance->instanceId);
+                continue;
+            }
+            memcpy(&(dst_instance->instance), src_instance, sizeof(ncInstance));
+            dst_instance->refs = 1;
+            if (!changed) {
+                instances_generation++;
+                changed = TRUE;
+            }
+            dst_instance->instance.generation = instances_generation;
+            dst_instance->disk_gb = get_disk_use_gb(&(src_instance->params));
+            new_snapshot->instances[i++] = &(dst_instance->instance);
+            add_resource_use(new_snapshot, dst_instance);
+        }
+        new_snapshot->instancesLen = i;
+        if (old_snapshot && (old_snapshot->instancesLen != i))
+            announce = TRUE;
+        generation = instances_generation;
+
+        // readers that still hold the old snapshot keep it, and its copies, alive
+        instances_snapshot = new_snapshot;
+        if (old_snapshot)
+            unref_instances_snapshot(old_snapshot);
+    }
+    sem_v(inst_copy_sem);
+
+    if (announce)
+        announce_instance_changes(generation);
+}
+
+//!
+//! Tells the CC that the instances on this node changed state, so that it refreshes its view of
+//! them right away rather than at its next poll. The announcement is a UDP datagram, carrying the
+//! instance generation, sent to the port the CC serves requests on. It is only a hint, which the
+//! CC follows up on with a DescribeInstances, and it is best effort: if it is lost, or the CC is
+//! not listening, the CC just finds out at its next poll. The CC is only known once it has sent a
+//! request with the services info, and only by IP address, so announcing never waits on a lookup.
+//!
+//! @param[in] generation the instance generation of the snapshot being announced
+//!
+static void announce_instance_changes(long long generation)
+{
+    int len = 0;
+    int port = 0;
+    char url[512] = "";
+    char type[512] = "";
+    char host[512] = "";
+    char path[512] = "";
+    char msg[64] = "";
+    struct sockaddr_in addr = { 0 };
+    static int fd = -1;
+
+    if ((get_service_url("cluster", &nc_state, url) != EUCA_OK) || tokenize_uri(url, type, host, &port, path) || (port <= 0))
+        return;
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &(addr.sin_addr)) != 1)
+        return;
+
+    // called with inst_sem held, which also guards fd
+    if ((fd < 0) && ((fd = socket(AF_INET, (SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0)) < 0)) {
+        LOGWARN("cannot create socket for instance announcements: %s\n", strerror(errno));
+        return;
+    }
+
+    len = snprintf(msg, sizeof(msg), "instances %lld", generation);
+    if (sendto(fd, msg, len, 0, ((struct sockaddr *)&addr), sizeof(addr)) < 0) {
+        LOGTRACE("could not announce instance generation %lld to %s:%d: %s\n", generation, host, port, strerror(errno));
+        return;
+    }
+    LOGTRACE("announced instance generation %lld to %s:%d\n", generation, host, port);
+}
+
+//!
+//! Adds the resources taken up by an instance to the sums of a snapshot
+//!
+//! @param[in] snapshot the snapshot being built
+//! @param[in] copy the copy of the instance in the snapshot
+//!
+static void add_resource_use(instancesSnapshot * snapshot, const sharedInstance * copy)
+{
+    if (copy->instance.state == TEARDOWN)
+        return;                        // they don't take up resources
+    snapshot->sum_mem += copy->instance.params.mem;
+    snapshot->sum_disk += copy->disk_gb;
+    snapshot->sum_cores += copy->instance.params.cores;
+}
+
+//!
+//! Drops a reference to a snapshot, freeing it once unused. Must be called with inst_copy_sem held.
+//!
+//! @param[in] snapshot the snapshot to release
+//!
+static void unref_instances_snapshot(instancesSnapshot * snapshot)
+{
+    int i = 0;
+    sharedInstance *copy = NULL;
+
+    if (--(snapshot->refs) > 0)
+        return;
+
+    for (i = 0; i < snapshot->instancesLen; i++) {
+        copy = ((sharedInstance *) snapshot->instances[i]);
+        if (--(copy->refs) == 0)
+            EUCA_SLAB_FREE(&shared_instance_slab, copy);
+    }
+    EUCA_FREE(snapshot->instances);
+    EUCA_FREE(snapshot);
+}
+
+//!
+//! Returns the published snapshot of the instances, which stays valid and unchanged until
+//! released with release_instances_snapshot(), even if a newer one is published meanwhile.
+//! Neither the snapshot nor its instances may be modified.
+//!
+//! @return a pointer to the snapshot or NULL if none has been published yet
+//!
+instancesSnapshot *acquire_instances_snapshot(void)
+{
+    instancesSnapshot *snapshot = NULL;
+
+    sem_p(inst_copy_sem);
+    if ((snapshot = instances_snapshot) != NULL)
+        snapshot->refs++;
+    sem_v(inst_copy_sem);
+
+    return (snapshot);
+}
+
+//!
+//! Releases a snapshot obtained from acquire_instances_snapshot()
+//!
+//! @param[in] snapshot the snapshot to release, may be NULL
+//!
+void release_instances_snapshot(instancesSnapshot * snapshot)
+{
+    if (snapshot == NULL)
+        return;
+
+    sem_p(inst_copy_sem);
+    unref_instances_snapshot(snapshot);
+    sem_v(inst_copy_sem);
+}
+
+//!
+//! Takes a reference to an instance copy from a snapshot, so that it can be used after the
+//! snapshot is released, e.g., in a DescribeInstances reply
+//!
+//! @param[in] instance an instance from a snapshot
+//!
+//! @return the same instance, to be released with release_instance_copy()
+//!
+ncInstance *ref_instance_copy(ncInstance * instance)
+{
+    sem_p(inst_copy_sem);
+    ((sharedInstance *) instance)->refs++;
+    sem_v(inst_copy_sem);
+
+    return (instance);
+}
+
+//!
+//! Releases an instance copy obtained from ref_instance_copy(), e.g., one returned by
+//! doDescribeInstances()
+//!
+//! @param[in] instance the instance to release, may be NULL
+//!
+void release_instance_copy(ncInstance * instance)
+{
+    sharedInstance *copy = ((sharedInstance *) instance);
+
+    if (copy == NULL)
+        return;
+
+    sem_p(inst_copy_sem);
+    if (--(copy->refs) == 0)
+        EUCA_FREE(copy);
+    sem_v(inst_copy_sem);
+}
+
+//!
+//! Returns the current value of the instance generation counter, see copy_instances().
+//! Every instance in the published snapshot has a generation at or below this value.
+//!
+//! @return the instance generation, or 0 if no copy has been made yet
+//!
+long long get_instances_generation(void)
+{
+    long long generation = 0;
+
+    sem_p(inst_copy_sem);
+    generation = instances_generation;
+    sem_v(inst_copy_sem);
+
+    return (generation);
+}
+
+//!
+//! helper that is used during initialization and by monitornig thread
+//!
+static void update_log_params(void)
+{
+    int log_level = 0;
+    int log_roll_number = 0;
+    long log_max_size_bytes = 0;
+    char *log_prefix = NULL;
+    char *log_facility = NULL;
+    char *log_async = NULL;
+
+    // read log params from config file and update in-memory configuration
+    configReadLogParams(&log_level, &log_roll_number, &log_max_size_bytes, &log_prefix);
+
+    // reconfigure the logging subsystem to use the new values, if any
+    log_params_set(log_level, log_roll_number, log_max_size_bytes);
+    log_prefix_set(log_prefix);
+    EUCA_FREE(log_prefix);
+
+    if ((log_facility = configFileValue("LOGFACILITY")) != NULL) {
+        if (strlen(log_facility) > 0) {
+            log_facility_set(log_facility, "nc");
+        }
+        EUCA_FREE(log_facility);
+    }
+
+    if ((log_async = configFileValue("LOGASYNC")) != NULL) {
+        log_async_set(log_async);
+        EUCA_FREE(log_async);
+    }
+}
+
+//!
+//! helper that is used during initialization and by monitornig thread
+//!
+static void update_ebs_params(void)
+{
+    char * ceph_user = configSnapshotValue(CONFIG_NC_CEPH_USER);
+    char * ceph_keys = configSnapshotValue(CONFIG_NC_CEPH_KEYS);
+    char * ceph_conf = configSnapshotValue(CONFIG_NC_CEPH_CONF);
+    init_iscsi(nc_state.home,
+               (ceph_user==NULL)?(DEFAULT_CEPH_USER):(ceph_user),
+               (ceph_keys==NULL)?(DEFAULT_CEPH_KEYRING):(ceph_keys),
+               (ceph_conf==NULL)?(DEFAULT_CEPH_CONF):(ceph_conf));
+    EUCA_FREE(ceph_user);
+    EUCA_FREE(ceph_keys);
+    EUCA_FREE(ceph_conf);
+}
+
+//!
+//! helper that is used during initialization and by monitornig thread, which also applies
+//! the new caps to the running instances and lifts the caps no longer set
+//!
+//! @param[in] live set to TRUE to apply the caps to the domains that are already running
+//!
+static void update_qos_params(boolean live)
+{
+    char *qos = configSnapshotValue(CONFIG_INSTANCE_QOS);
+    int len = set_qos_profiles(qos);
+#if LIBVIR_VERSION_NUMBER >= 1002008
+    qosProfile profile = { {0} };
+    ncInstance *instance = NULL;
+    instancesSnapshot *snapshot = NULL;
+    virConnectPtr conn = NULL;
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+
+    EUCA_FREE(qos);
+    if (len < 0) {
+        LOGERROR("ignoring malformed %s, the caps of the instances are unchanged\n", CONFIG_INSTANCE_QOS);
+        return;
+    }
+    LOGDEBUG("%d QoS profile(s) set from %s\n", len, CONFIG_INSTANCE_QOS);
+
+#if LIBVIR_VERSION_NUMBER >= 1002008
+    if (!live || ((snapshot = acquire_instances_snapshot()) == NULL))
+        return;
+
+    for (int i = 0; i < snapshot->instancesLen; i++) {
+        instance = snapshot->instances[i];
+        if (!qos_instance(instance))
+            continue;
+
+        if (!get_qos_profile(instance->params.name, &profile))
+            bzero(&profile, sizeof(profile));
+
+        if ((conn == NULL) && ((conn = lock_hypervisor_conn()) == NULL))
+            break;
+
+        if (qos_domain(conn, instance, &profile, TRUE) != 1)
+            LOGWARN("[%s] caps of VM type %s are not in effect on all devices\n", instance->instanceId, instance->params.name);
+    }
+
+    if (conn)
+        unlock_hypervisor_conn();
+    release_instances_snapshot(snapshot);
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+}
+
+//!
+//! Sets up the memory density mode, in which instances are packed on the memory they
+//! actually use: KSM merges the identical pages of the guests, the guests report what
+//! they leave unused through their virtio balloon, and density_mem_free() works out the
+//! memory left from the resident memory of the domains, up to NC_MEMORY_OVERCOMMIT_RATIO
+//! times the memory of the NC.
+//!
+static void init_memory_density(void)
+{
+    char *s = NULL;
+    char *end = NULL;
+    char *run = NULL;
+    double ratio = 1.0;
+    int rc = EUCA_OK;
+
+    nc_state.mem_overcommit_ratio = 1.0;
+    if (!nc_state.memory_density)
+        return;
+
+    // huge pages are neither merged by KSM nor counted in the resident memory of the domains
+    if (nc_state.huge_pages_kb) {
+        LOGWARN("ignoring %s, which does not work with %s\n", CONFIG_MEMORY_DENSITY, CONFIG_HUGE_PAGES);
+        nc_state.memory_density = FALSE;
+        return;
+    }
+
+    if ((s = getConfString(nc_state.configFiles, 2, CONFIG_MEMORY_OVERCOMMIT)) != NULL) {
+        ratio = strtod(s, &end);
+        if ((end == s) || (*end != '\0') || (ratio < 1.0)) {
+            LOGWARN("ignoring %s value '%s' (must be a number no less than 1.0)\n", CONFIG_MEMORY_OVERCOMMIT, s);
+            ratio = 1.0;
+        }
+        EUCA_FREE(s);
+    }
+    nc_state.mem_overcommit_ratio = ratio;
+
+    if (((run = file2str(KSM_RUN_PATH)) == NULL) || (atoi(run) != 1)) {
+        if ((rc = euca_execlp(NULL, nc_state.rootwrap_cmd_path, "sh", "-c", "echo 1 > " KSM_RUN_PATH, NULL)) != EUCA_OK)
+            LOGWARN("failed to start KSM through %s, identical guest pages will not be merged\n", KSM_RUN_PATH);
+    }
+    EUCA_FREE(run);
+
+    LOGINFO("memory density: KSM on, balloon statistics every %d seconds, up to %.2f times %lldMB handed out\n", nc_state.config_balloon_stats_period,
+            nc_state.mem_overcommit_ratio, nc_state.mem_max);
+}
+
+//!
+//! Samples the memory that the running domains take up on the host and that their guests
+//! leave unused, along with what KSM saves, for density_mem_free(). Works on the snapshot
+//! of the instances and the query connection, so it holds up neither requests nor domain
+//! operations.
+//!
+static void sample_memory_density(void)
+{
+    int n = 0;
+    int nstats = 0;
+    long long shared_kb = 0;
+    char *pages = NULL;
+    ncInstance *instance = NULL;
+    instancesSnapshot *snapshot = NULL;
+    virConnectPtr conn = NULL;
+    virDomainPtr dom = NULL;
+    virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
+    densityDomain *domains = NULL;
+
+    if ((domains = EUCA_ZALLOC(MAXINSTANCES_PER_NC, sizeof(densityDomain))) == NULL)
+        return;
+
+    if ((snapshot = acquire_instances_snapshot()) != NULL) {
+        for (int i = 0; (i < snapshot->instancesLen) && (n < MAXINSTANCES_PER_NC); i++) {
+            instance = snapshot->instances[i];
+            if ((instance->state != RUNNING) && (instance->state != BLOCKED) && (instance->state != PAUSED))
+                continue;
+
+            if ((conn == NULL) && ((conn = lock_hypervisor_query_conn()) == NULL))
+                break;
+
+            if ((dom = virDomainLookupByName(conn, instance->instanceId)) == NULL)
+                continue;
+            nstats = virDomainMemoryStats(dom, stats, VIR_DOMAIN_MEMORY_STAT_NR, 0);
+            virDomainFree(dom);
+
+            domains[n].rss_kb = 0;
+            domains[n].unused_kb = -1;
+            for (int j = 0; j < nstats; j++) {
+                if (stats[j].tag == VIR_DOMAIN_MEMORY_STAT_RSS)
+                    domains[n].rss_kb = stats[j].val;
+                else if (stats[j].tag == VIR_DOMAIN_MEMORY_STAT_UNUSED)
+                    domains[n].unused_kb = stats[j].val;
+            }
+
+            // a domain without a sample counts at its full size
+            if (domains[n].rss_kb == 0)
+                continue;
+            euca_strncpy(domains[n].instanceId, instance->instanceId, sizeof(domains[n].instanceId));
+            domains[n].mem_mb = instance->params.mem;
+            n++;
+        }
+
+        if (conn)
+            unlock_hypervisor_query_conn(conn);
+        release_instances_snapshot(snapshot);
+    }
+    // the pages KSM merged are counted in the resident memory of every domain sharing them
+    if ((pages = file2str(KSM_PAGES_SHARING_PATH)) != NULL) {
+        shared_kb = (atoll(pages) * (sysconf(_SC_PAGESIZE) / 1024));
+        EUCA_FREE(pages);
+    }
+
+    pthread_mutex_lock(&density_mutex);
+    {
+        memcpy(density_domains, domains, (n * sizeof(densityDomain)));
+        density_domains_len = n;
+        density_shared_kb = shared_kb;
+    }
+    pthread_mutex_unlock(&density_mutex);
+    EUCA_FREE(domains);
+}
+
+//!
+//! Works out the memory left for new instances in the memory density mode. It is the least
+//! of what is left of NC_MEMORY_OVERCOMMIT_RATIO times the memory of the NC once the memory
+//! the instances asked for is handed out, and of what the domains leave of the memory of
+//! the NC, as last sampled. Instances with no sample yet, e.g., booting ones, count at their
+//! full size.
+//!
+//! @param[in] sum_mem memory, in MB, that the instances of the NC asked for
+//!
+//! @return the memory left, in MB
+//!
+long long density_mem_free(long long sum_mem)
+{
+    long long committed_free = 0;
+    long long resident_free = 0;
+    long long sampled_mb = 0;
+    long long rss_kb = 0;
+
+    pthread_mutex_lock(&density_mutex);
+    {
+        for (int i = 0; i < density_domains_len; i++) {
+            sampled_mb += density_domains[i].mem_mb;
+            rss_kb += density_domains[i].rss_kb;
+        }
+        rss_kb -= density_shared_kb;
+    }
+    pthread_mutex_unlock(&density_mutex);
+
+    committed_free = ((long long)(nc_state.mem_max * nc_state.mem_overcommit_ratio)) - sum_mem;
+    resident_free = nc_state.mem_max - (MAX(rss_kb, 0) / 1024) - MAX((sum_mem - sampled_mb), 0);
+    return (MAX(MIN(committed_free, resident_free), 0));
+}
+
+//!
+//! Prints the sampled memory use of the domains, in the memory density mode
+//!
+//! @param[in] f the file to print to
+//!
+static void print_memory_density(FILE * f)
+{
+    if (!nc_state.memory_density)
+        return;
+
+    pthread_mutex_lock(&density_mutex);
+    {
+        fprintf(f, "memory density: overcommit %.2f shared by KSM MB: %lld\n", nc_state.mem_overcommit_ratio, density_shared_kb / 1024);
+        for (int i = 0; i < density_domains_len; i++) {
+            fprintf(f, " %s memory (asked/resident/unused) MB: %lld/%lld/", density_domains[i].instanceId, density_domains[i].mem_mb, density_domains[i].rss_kb / 1024);
+            if (density_domains[i].unused_kb < 0)
+                fprintf(f, "-\n");
+            else
+                fprintf(f, "%lld\n", density_domains[i].unused_kb / 1024);
+        }
+    }
+    pthread_mutex_unlock(&density_mutex);
+}
+
+//!
+//! Tells whether an instance has a domain that the caps of the QoS profiles apply to
+//!
+//! @param[in] instance pointer to the instance
+//!
+//! @return TRUE if the instance is running on KVM, FALSE otherwise
+//!
+static boolean qos_instance(const ncInstance * instance)
+{
+    if ((instance->state != RUNNING) && (instance->state != BLOCKED) && (instance->state != PAUSED))
+        return (FALSE);
+    return ((!strcmp(instance->hypervisorType, "kvm") || !strcmp(instance->hypervisorType, "qemu")) ? TRUE : FALSE);
+}
+
+#if LIBVIR_VERSION_NUMBER >= 1002008
+//!
+//! Applies the caps of a QoS profile to the disks and network cards of the running domain
+//! of an instance, leaving its definition alone, and checks that libvirt enforces them.
+//!
+//! @param[in] conn the hypervisor connection to use
+//! @param[in] instance pointer to the instance
+//! @param[in] profile the caps, 0 meaning no cap
+//! @param[in] apply set to TRUE to apply the caps before checking them
+//!
+//! @return 1 if all the devices have the caps, 0 if some do not or -1 on failure
+//!
+static int qos_domain(virConnectPtr conn, const ncInstance * instance, const qosProfile * profile, boolean apply)
+{
+    int ret = 1;
+    int nparams = 0;
+    int maxparams = 0;
+    unsigned int j = 0;
+    unsigned int count = 0;
+    unsigned int kbs_in = 0;
+    unsigned int kbs_out = 0;
+    unsigned long long iops = 0;
+    unsigned long long bytes = 0;
+    char key[VIR_TYPED_PARAM_FIELD_LENGTH] = "";
+    const char *dev = NULL;
+    virDomainPtr dom = NULL;
+    virDomainPtr doms[2] = { NULL };
+    virTypedParameterPtr params = NULL;
+    virDomainStatsRecordPtr rec = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+
+    if ((dom = virDomainLookupByName(conn, instance->instanceId)) == NULL)
+        return (-1);
+
+    // the names of the devices, as libvirt knows them
+    doms[0] = dom;
+    if (virDomainListGetStats(doms, (VIR_DOMAIN_STATS_BLOCK | VIR_DOMAIN_STATS_INTERFACE), &records, 0) != 1) {
+        virDomainFree(dom);
+        return (-1);
+    }
+    rec = records[0];
+
+    count = 0;
+    virTypedParamsGetUInt(rec->params, rec->nparams, "block.count", &count);
+    for (j = 0; (j < count) && (ret >= 0); j++) {
+        snprintf(key, sizeof(key), "block.%u.name", j);
+        if (virTypedParamsGetString(rec->params, rec->nparams, key, &dev) != 1)
+            continue;
+
+        if (apply) {
+            nparams = maxparams = 0;
+            virTypedParamsAddULLong(&params, &nparams, &maxparams, VIR_DOMAIN_BLOCK_IOTUNE_TOTAL_IOPS_SEC, profile->diskIops);
+            virTypedParamsAddULLong(&params, &nparams, &maxparams, VIR_DOMAIN_BLOCK_IOTUNE_TOTAL_BYTES_SEC, profile->diskBytes);
+            if (virDomainSetBlockIoTune(dom, dev, params, nparams, VIR_DOMAIN_AFFECT_LIVE))
+                LOGWARN("[%s] failed to set the caps of disk %s\n", instance->instanceId, dev);
+            virTypedParamsFree(params, nparams);
+            params = NULL;
+        }
+        // a first call with no parameters gets how many there are
+        nparams = 0;
+        if ((virDomainGetBlockIoTune(dom, dev, NULL, &nparams, VIR_DOMAIN_AFFECT_LIVE) < 0) || ((params = EUCA_ZALLOC(nparams, sizeof(virTypedParameter))) == NULL)
+            || (virDomainGetBlockIoTune(dom, dev, params, &nparams, VIR_DOMAIN_AFFECT_LIVE) < 0)) {
+            ret = -1;
+        } else {
+            iops = bytes = 0;
+            virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_BLOCK_IOTUNE_TOTAL_IOPS_SEC, &iops);
+            virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_BLOCK_IOTUNE_TOTAL_BYTES_SEC, &bytes);
+            if ((iops != profile->diskIops) || (bytes != profile->diskBytes))
+                ret = 0;
+        }
+        if (params)
+            virTypedParamsClear(params, nparams);
+        EUCA_FREE(params);
+    }
+
+    count = 0;
+    virTypedParamsGetUInt(rec->params, rec->nparams, "net.count", &count);
+    for (j = 0; (j < count) && (ret >= 0); j++) {
+        snprintf(key, sizeof(key), "net.%u.name", j);
+        if (virTypedParamsGetString(rec->params, rec->nparams, key, &dev) != 1)
+            continue;
+
+        if (apply) {
+            nparams = maxparams = 0;
+            virTypedParamsAddUInt(&params, &nparams, &maxparams, VIR_DOMAIN_BANDWIDTH_IN_AVERAGE, profile->netInKBs);
+            virTypedParamsAddUInt(&params, &nparams, &maxparams, VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE, profile->netOutKBs);
+            if (virDomainSetInterfaceParameters(dom, dev, params, nparams, VIR_DOMAIN_AFFECT_LIVE))
+                LOGWARN("[%s] failed to set the caps of network card %s\n", instance->instanceId, dev);
+            virTypedParamsFree(params, nparams);
+            params = NULL;
+        }
+
+        nparams = 0;
+        if ((virDomainGetInterfaceParameters(dom, dev, NULL, &nparams, VIR_DOMAIN_AFFECT_LIVE) < 0)
+            || ((params = EUCA_ZALLOC(nparams, sizeof(virTypedParameter))) == NULL)
+            || (virDomainGetInterfaceParameters(dom, dev, params, &nparams, VIR_DOMAIN_AFFECT_LIVE) < 0)) {
+            ret = -1;
+        } else {
+            kbs_in = kbs_out = 0;
+            virTypedParamsGetUInt(params, nparams, VIR_DOMAIN_BANDWIDTH_IN_AVERAGE, &kbs_in);
+            virTypedParamsGetUInt(params, nparams, VIR_DOMAIN_BANDWIDTH_OUT_AVERAGE, &kbs_out);
+            if ((kbs_in != profile->netInKBs) || (kbs_out != profile->netOutKBs))
+                ret = 0;
+        }
+        if (params)
+            virTypedParamsClear(params, nparams);
+        EUCA_FREE(params);
+    }
+
+    virDomainStatsRecordListFree(records);
+    virDomainFree(dom);
+    return (ret);
+}
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+
+//!
+//! This defines the NC thread that periodically gives back to the file system the blocks
+//! of cached images that hold nothing but zeroes
+//!
+//! @param[in] arg a transparent pointer to the global NC state structure
+//!
+//! @return Always return NULL
+//!
+void *reclaiming_thread(void *arg)
+{
+    LOGINFO("spawning reclaiming thread\n");
+    if (arg == NULL) {
+        LOGFATAL("internal error (NULL parameter to reclaiming_thread)\n");
+        return NULL;
+    }
+
+    for (;;) {
+        sleep(RECLAIMING_PERIOD);
+        reclaim_backing_store();
+    }
+
+    return NULL;
+}
+
+//!
+//! This defines the NC thread that, while no instance is being launched, brings back into the
+//! cache the images launched most often on this node, resting in between so that the average
+//! rate of pre-staging stays under the configured bandwidth
+//!
+//! @param[in] arg a transparent pointer to the global NC state structure
+//!
+//! @return Always return NULL
+//!
+void *prestaging_thread(void *arg)
+{
+    boolean is_idle = TRUE;
+    time_t started = 0;
+    long long staged = 0;
+    long long rest_sec = 0;
+    bunchOfInstances *head = NULL;
+
+    LOGINFO("spawning pre-staging thread\n");
+    if (arg == NULL) {
+        LOGFATAL("internal error (NULL parameter to prestaging_thread)\n");
+        return NULL;
+    }
+
+    for (;;) {
+        sleep(PRESTAGING_PERIOD);
+
+        is_idle = TRUE;
+        sem_p(inst_sem);
+        for (head = global_instances; head; head = head->next) {
+            if ((head->instance->state == STAGING) || (head->instance->state == BOOTING))
+                is_idle = FALSE;
+        }
+        sem_v(inst_sem);
+        if (!is_idle)
+            continue;
+
+        started = time(NULL);
+        if ((staged = prestage_backing_store()) > 0) {
+            rest_sec = (staged / ((long long)nc_state.prestage_bandwidth_mbs * MEGABYTE)) - (time(NULL) - started);
+            if (rest_sec > 0)
+                sleep(rest_sec);
+        }
+    }
+
+    return NULL;
+}
+
+//!
+//! This defines the NC thread that, while no instance is being launched, moves images between
+//! the tiers of the cache, promoting the hottest into the fast tier
+//!
+//! @param[in] arg a transparent pointer to the global NC state structure
+//!
+//! @return Always return NULL
+//!
+void *tiering_thread(void *arg)
+{
+    boolean is_idle = TRUE;
+    bunchOfInstances *head = NULL;
+
+    LOGINFO("spawning cache tiering thread\n");
+    if (arg == NULL) {
+        LOGFATAL("internal error (NULL parameter to tiering_thread)\n");
+        return NULL;
+    }
+
+    for (;;) {
+        sleep(TIERING_PERIOD);
+
+        is_idle = TRUE;
+        sem_p(inst_sem);
+        for (head = global_instances; head; head = head->next) {
+            if ((head->instance->state == STAGING) || (head->instance->state == BOOTING))
+                is_idle = FALSE;
+        }
+        sem_v(inst_sem);
+        if (!is_idle)
+            continue;
+
+        // one image at a time, checking for launches in between
+        tier_backing_store_cache();
+    }
+
+    return NULL;
+}
+
+//!
+//! Tells whether an instance needs its state polled even when domain events are delivered:
+//! while booting, migrating or being shut down for bundling, after a failed lookup, or until
+//! its IP addresses are discovered
+//!
+//! @param[in] instance a pointer to the instance
+//!
+//! @return TRUE if the instance should be refreshed on this monitoring pass or FALSE otherwise
+//!
+static boolean instance_in_flux(ncInstance * instance)
+{
+    if ((instance->state == BOOTING) || (instance->state == BUNDLING_SHUTDOWN) || (instance->state == CREATEIMAGE_SHUTDOWN))
+        return (TRUE);
+    if ((instance->migration_state != NOT_MIGRATING) || (instance->retries < LIBVIRT_QUERY_RETRIES))
+        return (TRUE);
+    if ((instance->state == RUNNING || instance->state == BLOCKED || instance->state == PAUSED)
+        && (!strncmp(instance->ncnet.privateIp, "0.0.0.0", IP_BUFFER_SIZE) || !strncmp(instance->ncnet.publicIp, "0.0.0.0", IP_BUFFER_SIZE)))
+        return (TRUE);
+    return (FALSE);
+}
+
+//!
+//! Waits out the monitoring period, refreshing right away the instances that the hypervisor
+//! reports lifecycle events about. Without domain events, this is a plain sleep.
+//!
+//! @param[in] nc a pointer to the global NC state structure.
+//! @param[in] period how long to wait, in seconds
+//!
+static void wait_for_domain_events(struct nc_state_t *nc, int period)
+{
+    boolean pending = FALSE;
+    char name[CHAR_BUFFER_SIZE] = "";
+    ncInstance *instance = NULL;
+    struct timespec deadline = { 0 };
+
+    if (clock_gettime(CLOCK_REALTIME, &deadline) == -1) {
+        sleep(period);
+        return;
+    }
+    deadline.tv_sec += period;
+
+    for (;;) {
+        pthread_mutex_lock(&domain_events_mutex);
+        while (domain_events_len == 0) {
+            if (pthread_cond_timedwait(&domain_events_cond, &domain_events_mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        pending = ((domain_events_len > 0) ? TRUE : FALSE);
+        pthread_mutex_unlock(&domain_events_mutex);
+        if (!pending)
+            return;
+
+        sem_p(inst_sem);
+        for (;;) {
+            pthread_mutex_lock(&domain_events_mutex);
+            if ((pending = ((domain_events_len > 0) ? TRUE : FALSE)) == TRUE)
+                euca_strncpy(name, domain_events[--domain_events_len], sizeof(name));
+            pthread_mutex_unlock(&domain_events_mutex);
+            if (!pending)
+                break;
+
+            if ((instance = find_instance(&global_instances, name)) != NULL) {
+                LOGDEBUG("[%s] refreshing instance after domain event\n", instance->instanceId);
+                refresh_instance_info(nc, instance);
+            }
+        }
+        copy_instances();
+        sem_v(inst_sem);
+    }
+}
+
+//!
+//! This defines the NC monitoring thread
+//!
+//! @param[in] arg a transparent pointer to the global NC state structure
+//!
+//! @return Always return NULL
+//!
+void *monitoring_thread(void *arg)
+{
+#define EUCANETD_PID_FILE         "%s/var/run/eucalyptus/eucanetd.pid"
+#define EUCANETD_SERVICE_NAME     "eucanetd"
+
+    int i = 0;
+    int tmpint = 0;
+    int cleaned_up = 0;
+    int destroy_files = 0;
+    u32 ipHex = 0;
+    char *psPid = NULL;
+    char sPidFile[EUCA_MAX_PATH] = "";
+    char nfile[EUCA_MAX_PATH] = "";
+    char nfilefinal[EUCA_MAX_PATH] = "";
+    char URL[EUCA_MAX_PATH] = "";
+    char ccHost[EUCA_MAX_PATH] = "";
+    char clcHost[EUCA_MAX_PATH] = "";
+    char tmpbuf[EUCA_MAX_PATH] = "";
+    long long iteration = 0;
+    boolean sweep = FALSE;
+    time_t last_sweep = 0;
+    long long work_fs_size_mb = 0;
+    long long work_fs_avail_mb = 0;
+    long long cache_fs_size_mb = 0;
+    long long cache_fs_avail_mb = 0;
+    FILE *FP = NULL;
+    time_t now = 0;
+    struct nc_state_t *nc = NULL;
+    bunchOfInstances *head = NULL;
+    ncInstance *instance = NULL;
+    cleanupBatch *batch = NULL;
+
+    LOGINFO("spawning monitoring thread\n");
+    if (arg == NULL) {
+        LOGFATAL("internal error (NULL parameter to monitoring_thread)\n");
+        return NULL;
+    }
+
+    nc = ((struct nc_state_t *)arg);
+
+    for (iteration = 0; TRUE; iteration++) {
+        now = time(NULL);
+
+        expire_migration_keys();
+
+        // EUCA-10056 we need to check if EUCANETD is running when in EDGE of VPC mode
+        if (!strcmp(nc_state.vnetconfig->mode, NETMODE_EDGE)) {
+            snprintf(sPidFile, EUCA_MAX_PATH, EUCANETD_PID_FILE, nc_state.home);
+            if ((psPid = file2str(sPidFile)) != NULL) {
+                // Is the
+                if (euca_is_running(atoi(psPid), EUCANETD_SERVICE_NAME)) {
+                    if (nc_state.isEucanetdEnabled == FALSE)
+                        LOGDEBUG("Service %s detected and running.\n", EUCANETD_SERVICE_NAME);
+                    nc_state.isEucanetdEnabled = TRUE;
+                } else if (nc_state.isEucanetdEnabled) {
+                    // EUCANETD isn't running... Throw a fault for the user to correct
+                    LOGERROR("Service %s not running (even if PID file is detected).\n", EUCANETD_SERVICE_NAME);
+                    nc_state.isEucanetdEnabled = FALSE;
+                    log_eucafault("1008", "daemon", EUCANETD_SERVICE_NAME, NULL);
+                }
+                EUCA_FREE(psPid);
+            } else if (nc_state.isEucanetdEnabled) {
+                // EUCANETD isn't running... Throw a fault for the user to correct
+                LOGERROR("Service %s not running.\n", EUCANETD_SERVICE_NAME);
+                nc_state.isEucanetdEnabled = FALSE;
+                log_eucafault("1008", "daemon", EUCANETD_SERVICE_NAME, NULL);
+            }
+        }
+
+        sem_p(inst_sem);
+
+        snprintf(nfile, EUCA_MAX_PATH, EUCALYPTUS_LOG_DIR "/local-net.stage", nc_state.home);
+        snprintf(nfilefinal, EUCA_MAX_PATH, EUCALYPTUS_LOG_DIR "/local-net", nc_state.home);
+        if ((FP = fopen(nfile, "w")) == NULL) {
+            LOGWARN("could not open file %s for writing\n", nfile);
+        } else {
+            // print out latest CC and CLC IP addr to the local-net file
+            URL[0] = ccHost[0] = clcHost[0] = '\0';
+
+            for (i = 0; i < nc_state.servicesLen; i++) {
+                if (!strcmp(nc_state.services[i].type, "cluster")) {
+                    if (nc_state.services[i].urisLen > 0) {
+                        memcpy(URL, nc_state.services[i].uris[0], 512);
+                        if (strlen(URL)) {
+                            if (tokenize_uri(URL, tmpbuf, ccHost, &tmpint, tmpbuf)) {
+                                snprintf(ccHost, EUCA_MAX_PATH, "0.0.0.0");
+                            }
+                        }
+                    }
+                } else if (!strcmp(nc_state.services[i].type, "eucalyptus")) {
+                    if (nc_state.services[i].urisLen > 0) {
+                        memcpy(URL, nc_state.services[i].uris[0], 512);
+                        if (strlen(URL)) {
+                            if (tokenize_uri(URL, tmpbuf, clcHost, &tmpint, tmpbuf)) {
+                                snprintf(clcHost, EUCA_MAX_PATH, "0.0.0.0");
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (strlen(ccHost)) {
+                fprintf(FP, "CCIP=%s\n", ccHost);
+            }
+
+            if (strlen(clcHost)) {
+                fprintf(FP, "CLCIP=%s\n", clcHost);
+
+                // See if we're in system mode, which in this case we have some work to do
+                if (!strcmp(nc_state.vnetconfig->mode, NETMODE_SYSTEM)) {
+                    ipHex = dot2hex(clcHost);
+
+                    // don't change anything unless our cloud controller knowledge changed
+                    if (ipHex != nc_state.vnetconfig->cloudIp) {
+                        if (ipHex == 0) {
+                            // We lost the cloud controller IP, remove the metadata redirect first then
+                            // update vnetconfig second. The vnetUnsetMetadaRedirect() IP needs the old IP.
+                            // We only do this if we had a cloud IP set...
+                            if (nc_state.vnetconfig->cloudIp != 0) {
+                                if (vnetUnsetMetadataRedirect(nc_state.vnetconfig) == EUCA_OK) {
+                                    nc_state.vnetconfig->cloudIp = ipHex;
+                                    LOGDEBUG("Lost cloud controller IP information.\n");
+
+                                    // now save our config
+                                    if (gen_nc_xml(&nc_state) != EUCA_OK) {
+                                        LOGERROR("failed to update NC state on disk after learning new cloud IP\n");
+                                    }
+                                } else {
+                                    LOGERROR("Failed to unset metadata redirect after CLC loss.");
+                                }
+                            }
+                        } else {
+                            LOGDEBUG("Learned new cloud controller IP %s.\n", clcHost);
+
+                            // HA, YAY!!! Cloud controller IP changed, remove our old metadata redirect and
+                            // then update the IP and re-install the rule with the new IP.
+                            if (vnetUnsetMetadataRedirect(nc_state.vnetconfig) == EUCA_OK) {
+                                nc_state.vnetconfig->cloudIp = ipHex;
+                                vnetSetMetadataRedirect(nc_state.vnetconfig);
+
+                                // now save our config
+                                if (gen_nc_xml(&nc_state) != EUCA_OK) {
+                                    LOGERROR("failed to update NC state on disk after learning new cloud IP\n");
+                                }
+                            } else {
+                                LOGERROR("Failed to unset metadata redirect after CLC IP change.");
+                            }
+                        }
+                    }
+                }
+            }
+            fflush(FP);
+        }
+
+        // with domain events, settled instances are only polled on a slower reconciliation sweep
+        pthread_mutex_lock(&domain_events_mutex);
+        sweep = (!domain_events_live() || domain_events_overflow || ((now - last_sweep) >= MONITORING_RECONCILE_PERIOD));
+        domain_events_overflow = FALSE;
+        pthread_mutex_unlock(&domain_events_mutex);
+        if (sweep)
+            last_sweep = now;
+
+        cleaned_up = 0;
+        for (head = global_instances; head; head = head->next) {
+            instance = head->instance;
+
+            // query for current state, if any
+            if (sweep || instance_in_flux(instance))
+                refresh_instance_info(nc, instance);
+
+            // time out logic for migration-ready instances
+            if (!strcmp(instance->stateName, "Extant") && ((instance->migration_state == MIGRATION_READY) || (instance->migration_state == MIGRATION_PREPARING))
+                && ((now - instance->migrationTime) > nc_state.migration_ready_threshold)) {
+                if (instance->migrationTime) {
+                    if (outgoing_migrations_in_progress) {
+                        LOGINFO("[%s] has been in migration state '%s' on source for %d seconds (threshold is %d), but not rolling back due to %d ongoing outgoing migration[s]\n",
+                                instance->instanceId, migration_state_names[instance->migration_state], (int)(now - instance->migrationTime), nc_state.migration_ready_threshold,
+                                outgoing_migrations_in_progress);
+                        continue;
+                    }
+
+                    LOGWARN("[%s] has been in migration state '%s' on source for %d seconds (threshold is %d), rolling back [%d].\n",
+                            instance->instanceId, migration_state_names[instance->migration_state], (int)(now - instance->migrationTime), nc_state.migration_ready_threshold,
+                            instance->migrationTime);
+                    migration_rollback(instance);
+                    continue;
+                } else {
+                    if (instance->state == BOOTING) {
+                        // Assume destination node. (Is this a safe assumption?)
+                        LOGDEBUG("[%s] destination node ready: instance in booting state with no migrationTime.\n", instance->instanceId);
+                    } else {
+                        LOGWARN("[%s] in instance state '%s' is ready to migrate but has a zero instance migrationTime.\n",
+                                instance->instanceId, instance_state_names[instance->state]);
+                        migration_rollback(instance);
+                    }
+                }
+            }
+            // don't touch running or canceled threads
+            if (instance->state != STAGING && instance->state != BOOTING &&
+                instance->state != SHUTOFF &&
+                instance->state != SHUTDOWN &&
+                instance->state != BUNDLING_SHUTDOWN &&
+                instance->state != BUNDLING_SHUTOFF && instance->state != CREATEIMAGE_SHUTDOWN && instance->state != CREATEIMAGE_SHUTOFF && instance->state != TEARDOWN) {
+
+                if (FP && !strcmp(instance->stateName, "Extant")) {
+                    //! @TODO is this still being used?
+                    //! @TODO yes! for EDGE networking
+                    // have a running instance, write its information to local state file
+                    fprintf(FP, "%s %s %s %d %s %s %s\n",
+                            SP(instance->instanceId), SP(nc_state.vnetconfig->pubInterface), "NA", instance->ncnet.vlan, SP(instance->ncnet.privateMac),
+                            SP(instance->ncnet.publicIp), SP(instance->ncnet.privateIp));
+                    fflush(FP);
+                }
+                continue;
+            }
+
+            if (instance->state == TEARDOWN) {
+                // it's been long enough, we can forget the instance
+                if ((now - instance->terminationTime) > nc_state.teardown_state_duration) {
+                    remove_instance(&global_instances, instance);
+                    LOGINFO("[%s] forgetting about instance\n", instance->instanceId);
+                    free_instance(&instance);
+                    break;             // need to get out since the list changed
+                }
+                continue;
+            }
+            // time out logic for STAGING or BOOTING or BUNDLING instances
+            if (instance->state == STAGING && (now - instance->launchTime) < nc_state.staging_cleanup_threshold)
+                continue;              // hasn't been long enough, spare it
+
+            if (instance->state == BOOTING && (now - instance->bootTime) < nc_state.booting_cleanup_threshold)
+                continue;
+
+            if ((instance->state == BUNDLING_SHUTDOWN || instance->state == BUNDLING_SHUTOFF)
+                && (now - instance->bundlingTime) < nc_state.bundling_cleanup_threshold)
+                continue;
+
+            if ((instance->state == CREATEIMAGE_SHUTDOWN || instance->state == CREATEIMAGE_SHUTOFF)
+                && (now - instance->createImageTime) < nc_state.createImage_cleanup_threshold)
+                continue;
+
+            // terminate a booting instance as a special case, though not if it's an incoming migration
+            if (instance->state == BOOTING) {
+                if ((instance->migration_state == MIGRATION_PREPARING) || (instance->migration_state == MIGRATION_READY)) {
+                    LOGDEBUG("[%s] instance has exceeded BOOTING cleanup threshold of %d seconds, but has migration_state=%s, so not terminating\n", instance->instanceId,
+                             nc_state.booting_cleanup_threshold, migration_state_names[instance->migration_state]);
+                    continue;
+                } else {
+                    LOGDEBUG("[%s] finding and terminating BOOTING instance, which has exceeded cleanup threshold of %d seconds\n", instance->instanceId,
+                             nc_state.booting_cleanup_threshold);
+
+                    // do the shutdown in the termination thread
+                    queue_termination(instance->instanceId);
+                }
+            }
+            // while a batch is being cleaned up, the condemned instances wait for the next one
+            if ((cleanup_batch == NULL) && (cleaned_up < nc_state.concurrent_cleanup_ops)) {
+                // ok, it's been condemned => destroy the files, outside of inst_sem
+                if ((batch == NULL) && ((batch = EUCA_ZALLOC(1, sizeof(cleanupBatch))) == NULL)) {
+                    LOGERROR("[%s] out of memory for the cleanup of the instance\n", instance->instanceId);
+                    continue;
+                }
+                if ((batch->instances[batch->len] = clone_instance(instance)) == NULL) {
+                    LOGERROR("[%s] out of memory for the cleanup of the instance\n", instance->instanceId);
+                    continue;
+                }
+
+                cleaned_up++;
+                destroy_files = !nc_state.save_instance_files;
+                if (call_hooks(NC_EVENT_PRE_CLEAN, instance->instancePath)) {
+                    if (destroy_files) {
+                        LOGERROR("[%s] cancelled instance cleanup via hooks\n", instance->instanceId);
+                        destroy_files = 0;
+                    }
+                }
+                batch->destroy_files[batch->len++] = destroy_files;
+            }
+        }
+
+        // the batch is claimed here, under inst_sem, and handed over once it is released
+        if (batch != NULL)
+            cleanup_batch = batch;
+
+        if (FP) {
+            fclose(FP);
+            rename(nfile, nfilefinal);
+        }
+
+        copy_instances();              // publish a snapshot of global_instances
+        sem_v(inst_sem);
+
+        if (batch != NULL) {
+            // hand the condemned instances over to the cleanup thread
+            pthread_attr_t tattr;
+            pthread_t tid;
+            pthread_attr_init(&tattr);
+            pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&tid, &tattr, cleanup_thread, (void *)batch) != 0) {
+                LOGERROR("failed to start the cleanup thread, cleaning up %d instance(s) in place\n", batch->len);
+                cleanup_thread(batch); // this frees the batch and resets cleanup_batch
+            }
+            pthread_attr_destroy(&tattr);
+            batch = NULL;
+        }
+
+        if (head) {
+            // we got out because of modified list, no need to sleep now
+            continue;
+        }
+
+        wait_for_domain_events(nc, MONITORING_PERIOD);
+
+        // do this on every iteration (every MONITORING_PERIOD seconds)
+        if ((iteration % 1) == 0) {
+            // see if config file has changed and react to those changes
+            if (isConfigModified(nc_state.configFiles, 2) > 0) {    // config modification time has changed
+                if (readConfigFile(nc_state.configFiles, 2)) {
+                    // something has changed that can be read in
+                    LOGINFO("configuration file has been modified, ingressing new options\n");
+
+                    // log-related options
+                    update_log_params();
+
+                    // EBS-related options
+                    update_ebs_params();
+
+                    // disk and network caps of the instances
+                    update_qos_params(TRUE);
+
+                    //! @todo pick up other NC options dynamically?
+                }
+            }
+            // what the instances actually use, for density_mem_free()
+            if (nc_state.memory_density)
+                sample_memory_density();
+        }
+        // do this every 10th iteration (every 10*MONITORING_PERIOD seconds)
+        if ((iteration % 10) == 0) {
+            //! @todo 3.2 change 1 to 10
+
+            // make room in the cache ahead of time, so that launches do not have to wait for purging
+            evict_backing_store_cache();
+
+            // check file system state and blobstore state
+            blobstore_meta work_meta, cache_meta;
+            if (stat_backing_store(NULL, &work_meta, &cache_meta) == EUCA_OK) {
+                work_fs_size_mb = (long long)(work_meta.fs_bytes_size / MEGABYTE);
+                work_fs_avail_mb = (long long)(work_meta.fs_bytes_available / MEGABYTE);
+                cache_fs_size_mb = (long long)(cache_meta.fs_bytes_size / MEGABYTE);
+                cache_fs_avail_mb = (long long)(cache_meta.fs_bytes_available / MEGABYTE);
+
+                if (work_fs_avail_mb < ((work_fs_size_mb * DISK_TOO_LOW_PERCENT) / 100)) {
+                    log_eucafault("1003", "component", euca_this_component_name, "file", work_meta.path, NULL);
+                }
+
+                if (cache_fs_size_mb > 0 && cache_fs_avail_mb < ((cache_fs_size_mb * DISK_TOO_LOW_PERCENT) / 100)) {
+                    log_eucafault("1003", "component", euca_this_component_name, "file", cache_meta.path, NULL);
+                }
+                // writes to thin snapshots stall once their pool runs out of blocks
+                if (work_meta.pool_blocks_size > 0
+                    && (work_meta.pool_blocks_size - work_meta.pool_blocks_used) < ((work_meta.pool_blocks_size * DISK_TOO_LOW_PERCENT) / 100)) {
+                    LOGWARN("thin pool of %s is running out of space: %llu of %llu blocks used\n", work_meta.path, work_meta.pool_blocks_used, work_meta.pool_blocks_size);
+                }
+                //! @todo add more faults (cache or work reserved exceeds available space on file system)
+            }
+        }
+    }
+
+    return NULL;
+
+#undef EUCANETD_PID_FILE
+#undef EUCANETD_SERVICE_NAME
+}
+
+//!
+//! Counts the CPUs in a sysfs CPU list, such as "0-7,16-23"
+//!
+//! @param[in] cpulist
+//!
+//! @return the number of CPUs in the list
+//!
+static int count_cpus(const char *cpulist)
+{
+    int first = 0;
+    int last = 0;
+    int count = 0;
+    const char *p = cpulist;
+
+    while (p && *p) {
+        switch (sscanf(p, "%d-%d", &first, &last)) {
+        case 2:
+            count += ((last >= first) ? (last - first + 1) : 0);
+            break;
+        case 1:
+            count++;
+            break;
+        default:
+            return (count);
+        }
+        if ((p = strchr(p, ',')) != NULL)
+            p++;
+    }
+    return (count);
+}
+
+//!
+//! Discovers the NUMA nodes of the host and gives each its share of the cores and memory
+//! of the NC, so that instances can be placed on a node that has room for them. Nodes without
+//! CPUs are skipped. With huge pages, the memory of a node is its pool of huge pages.
+//!
+static void init_numa_topology(void)
+{
+    int cpus = 0;
+    int total_cpus = 0;
+    long long kb = 0;
+    long long total_mb = 0;
+    char path[EUCA_MAX_PATH] = "";
+    char *s = NULL;
+    char *line = NULL;
+    ncNumaNode *node = NULL;
+
+    nc_state.numa_nodes_len = 0;
+    if (!nc_state.numa_pinning)
+        return;
+
+    for (int id = 0; (id < MAX_NUMA_NODES) && (nc_state.numa_nodes_len < MAX_NUMA_NODES); id++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        if ((s = file2str(path)) == NULL)
+            continue;
+        if ((line = strchr(s, '\n')) != NULL)
+            *line = '\0';
+        cpus = count_cpus(s);
+
+        node = &nc_state.numa_nodes[nc_state.numa_nodes_len];
+        bzero(node, sizeof(ncNumaNode));
+        node->id = id;
+        euca_strncpy(node->cpus, s, sizeof(node->cpus));
+        EUCA_FREE(s);
+        if (cpus < 1)
+            continue;
+
+        kb = 0;
+        if (nc_state.huge_pages_kb) {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/hugepages/hugepages-%dkB/nr_hugepages", id, nc_state.huge_pages_kb);
+            if ((s = file2str(path)) != NULL)
+                kb = atoll(s) * nc_state.huge_pages_kb;
+            EUCA_FREE(s);
+        } else {
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", id);
+            if ((s = file2str(path)) != NULL) {
+                if ((line = strstr(s, "MemTotal:")) != NULL)
+                    sscanf(line, "MemTotal: %lld", &kb);
+            }
+            EUCA_FREE(s);
+        }
+
+        node->cores_max = cpus;
+        node->mem_max = kb / 1024;
+        total_cpus += cpus;
+        total_mb += node->mem_max;
+        nc_state.numa_nodes_len++;
+    }
+
+    if (nc_state.numa_nodes_len == 0) {
+        LOGWARN("no NUMA nodes found on the host, instances will not be pinned\n");
+        return;
+    }
+    // share out the cores and memory of the NC, which configuration may have raised or lowered
+    for (int i = 0; i < nc_state.numa_nodes_len; i++) {
+        node = &nc_state.numa_nodes[i];
+        node->cores_max = (int)((nc_state.cores_max * node->cores_max) / total_cpus);
+        if (!nc_state.huge_pages_kb && (total_mb > nc_state.mem_max))
+            node->mem_max = (nc_state.mem_max * node->mem_max) / total_mb;
+        node->cores_free = node->cores_max;
+        node->mem_free = node->mem_max;
+        LOGINFO("NUMA node %d (cpus %s): %d cores, %lldMB %s\n", node->id, node->cpus, node->cores_max, node->mem_max,
+                (nc_state.huge_pages_kb ? "in huge pages" : "of memory"));
+    }
+}
+
+//!
+//! Takes the cores and memory of an instance pinned to a NUMA node off the node
+//!
+//! @param[in] nodes copy of nc_state.numa_nodes to update
+//! @param[in] instance
+//!
+static void count_numa_usage(ncNumaNode * nodes, const ncInstance * instance)
+{
+    if (!instance->numaPinned || (instance->state == TEARDOWN))
+        return;                        // they don't take up resources
+
+    for (int i = 0; i < nc_state.numa_nodes_len; i++) {
+        if (nodes[i].id == instance->numaNode) {
+            nodes[i].cores_free -= instance->params.cores;
+            nodes[i].mem_free -= instance->params.mem;
+            break;
+        }
+    }
+}
+
+//!
+//! Pins an instance to the NUMA node with the most free memory among those with room for all
+//! of its cores and memory, and sets its huge page backing. An instance that fits on no node
+//! is left unpinned, spanning nodes.
+//!
+//! @param[in] instance
+//!
+static void place_instance_numa(ncInstance * instance)
+{
+    int best = -1;
+    bunchOfInstances *head = NULL;
+    ncNumaNode *node = NULL;
+
+    instance->numaPinned = FALSE;
+    instance->numaCpus[0] = '\0';
+    instance->hugePagesKB = nc_state.huge_pages_kb;
+    if (nc_state.numa_nodes_len == 0)
+        return;
+
+    sem_p(inst_sem);
+    {
+        for (int i = 0; i < nc_state.numa_nodes_len; i++) {
+            nc_state.numa_nodes[i].cores_free = nc_state.numa_nodes[i].cores_max;
+            nc_state.numa_nodes[i].mem_free = nc_state.numa_nodes[i].mem_max;
+        }
+        for (head = global_instances; head; head = head->next) {
+            if (head->instance != instance)
+                count_numa_usage(nc_state.numa_nodes, head->instance);
+        }
+
+        for (int i = 0; i < nc_state.numa_nodes_len; i++) {
+            node = &nc_state.numa_nodes[i];
+            if ((node->cores_free < instance->params.cores) || (node->mem_free < instance->params.mem))
+                continue;
+            if ((best < 0) || (node->mem_free > nc_state.numa_nodes[best].mem_free))
+                best = i;
+        }
+
+        if (best >= 0) {
+            node = &nc_state.numa_nodes[best];
+            instance->numaPinned = TRUE;
+            instance->numaNode = node->id;
+            euca_strncpy(instance->numaCpus, node->cpus, sizeof(instance->numaCpus));
+            node->cores_free -= instance->params.cores;
+            node->mem_free -= instance->params.mem;
+        }
+    }
+    sem_v(inst_sem);
+
+    if (instance->numaPinned) {
+        LOGINFO("[%s] pinned to NUMA node %d (cpus %s)\n", instance->instanceId, instance->numaNode, instance->numaCpus);
+    } else {
+        LOGINFO("[%s] fits on no single NUMA node, leaving it unpinned\n", instance->instanceId);
+    }
+}
+
+//!
+//! Prints the free cores and memory of each NUMA node
+//!
+//! @param[in] f the stream, nc-stats, to print to
+//! @param[in] instances the instances to count
+//! @param[in] instancesLen the number of instances
+//!
+static void print_numa_nodes(FILE * f, ncInstance ** instances, int instancesLen)
+{
+    ncNumaNode nodes[MAX_NUMA_NODES];
+
+    memcpy(nodes, nc_state.numa_nodes, sizeof(nodes));
+    for (int i = 0; i < nc_state.numa_nodes_len; i++) {
+        nodes[i].cores_free = nodes[i].cores_max;
+        nodes[i].mem_free = nodes[i].mem_max;
+    }
+    for (int i = 0; i < instancesLen; i++) {
+        count_numa_usage(nodes, instances[i]);
+    }
+    for (int i = 0; i < nc_state.numa_nodes_len; i++) {
+        fprintf(f, "numa node %d cores (max/avail/used): %d/%d/%d", nodes[i].id, nodes[i].cores_max, nodes[i].cores_free, nodes[i].cores_max - nodes[i].cores_free);
+        fprintf(f, " memory (max/avail/used) MB: %lld/%lld/%lld\n", nodes[i].mem_max, nodes[i].mem_free, nodes[i].mem_max - nodes[i].mem_free);
+    }
+}
+
+//!
+//! Fills in some of the fields of instance struct
+//!
+//! @param[in] instance struct to fill in
+//!
+void set_instance_params(ncInstance * instance)
+{
+    char *s = NULL;
+
+    if (nc_state.config_use_virtio_net) {
+        instance->params.nicType = NIC_TYPE_VIRTIO;
+    } else {
+        if (strstr(instance->platform, "windows")) {
+            instance->params.nicType = NIC_TYPE_WINDOWS;
+        } else {
+            instance->params.nicType = NIC_TYPE_LINUX;
+        }
+    }
+
+    euca_strncpy(instance->hypervisorType, nc_state.H->name, sizeof(instance->hypervisorType)); // set the hypervisor type
+
+    instance->hypervisorCapability = nc_state.capability;   // set the cap (xen/hw/hw+xen)
+    if ((s = system_output("getconf LONG_BIT")) != NULL) {
+        int bitness = atoi(s);
+        if (bitness == 32 || bitness == 64) {
+            instance->hypervisorBitness = bitness;
+        } else {
+            LOGWARN("[%s] can't determine the host's bitness (%s, assuming 64)\n", instance->instanceId, s);
+            instance->hypervisorBitness = 64;
+        }
+        EUCA_FREE(s);
+    } else {
+        LOGWARN("[%s] can't determine the host's bitness (assuming 64)\n", instance->instanceId);
+        instance->hypervisorBitness = 64;
+    }
+    instance->combinePartitions = nc_state.convert_to_disk;
+    instance->do_inject_key = nc_state.do_inject_key;
+    place_instance_numa(instance);
+}
+
+//!
+//! Waits for a launch to be admitted into a stage of the launch pipeline. Launches are admitted
+//! in the order they arrived, once fewer than the limit of the stage are in it.
+//!
+//! @param[in] instance the instance being launched
+//! @param[in] id the stage to enter
+//! @param[out] span handle of the tracing span of the stage, to be passed to leave_launch_stage()
+//!
+//! @return the time, in microseconds, at which the launch entered the stage, to be passed to leave_launch_stage()
+//!
+//! @see leave_launch_stage()
+//!
+static long long enter_launch_stage(ncInstance * instance, launchStageId id, int *span)
+{
+    long long ticket = 0;
+    long long arrived = mono_time_usec();
+    long long entered = 0;
+    char name[TRACE_NAME_SIZE] = "";
+    launchStage *stage = &launch_stages[id];
+
+    pthread_mutex_lock(&launch_stages_mutex);
+    {
+        ticket = stage->tickets++;
+        stage->queued++;
+        while ((ticket != stage->admitted) || ((stage->limit > 0) && (stage->active >= stage->limit))) {
+            pthread_cond_wait(&stage->cond, &launch_stages_mutex);
+        }
+        stage->queued--;
+        stage->admitted++;
+        stage->active++;
+        entered = mono_time_usec();
+        stage->wait_usec += (entered - arrived);
+        pthread_cond_broadcast(&stage->cond);   // the next ticket may fit as well
+    }
+    pthread_mutex_unlock(&launch_stages_mutex);
+
+    LOGTRACE("[%s] entered launch stage %s after %lld ms\n", instance->instanceId, stage->name, (entered - arrived) / 1000);
+    snprintf(name, sizeof(name), "launch.%s", stage->name);
+    *span = trace_begin(name);
+    return (entered);
+}
+
+//!
+//! Leaves a stage of the launch pipeline, letting the next queued launch in
+//!
+//! @param[in] instance the instance being launched
+//! @param[in] id the stage to leave
+//! @param[in] entered the value returned by enter_launch_stage()
+//! @param[in] span the handle set by enter_launch_stage()
+//!
+static void leave_launch_stage(ncInstance * instance, launchStageId id, long long entered, int span)
+{
+    long long ran = mono_time_usec() - entered;
+    launchStage *stage = &launch_stages[id];
+
+    pthread_mutex_lock(&launch_stages_mutex);
+    {
+        stage->active--;
+        stage->completed++;
+        stage->run_usec += ran;
+        pthread_cond_broadcast(&stage->cond);
+    }
+    pthread_mutex_unlock(&launch_stages_mutex);
+
+    trace_end(span, FALSE);
+    LOGDEBUG("[%s] launch stage %s took %lld ms\n", instance->instanceId, stage->name, ran / 1000);
+}
+
+//!
+//! Prints the queue depths and average latencies of the launch pipeline
+//!
+//! @param[in] f the stream, nc-stats, to print to
+//!
+static void print_launch_stages(FILE * f)
+{
+    launchStage *stage = NULL;
+
+    pthread_mutex_lock(&launch_stages_mutex);
+    for (int i = 0; i < LAUNCH_STAGES; i++) {
+        stage = &launch_stages[i];
+        fprintf(f, "launch stage %s (limit/active/queued/done): %d/%d/%d/%lld", stage->name, stage->limit, stage->active, stage->queued, stage->completed);
+        fprintf(f, " avg wait ms: %lld avg run ms: %lld\n", (stage->admitted ? (stage->wait_usec / stage->admitted / 1000) : 0),
+                (stage->completed ? (stage->run_usec / stage->completed / 1000) : 0));
+    }
+    pthread_mutex_unlock(&launch_stages_mutex);
+}
+
+//!
+//! Defines the instance startup thread
+//!
+//! @param[in] arg a transparent pointer to the instance structure to start
+//!
+//! @return Always return NULL
+//!
+void *startup_thread(void *arg)
+{
+    int i = 0;
+    int error = EUCA_OK;
+    int status = 0;
+    int rc = 0;
+    int span = -1;
+    int stage_span = -1;
+    long long entered = 0;
+    char *xml = NULL;
+    char *brname = NULL;
+    pid_t cpid = 0;
+    boolean try_killing = FALSE;
+    boolean created = FALSE;
+    ncInstance *instance = ((ncInstance *) arg);
+    virDomainPtr dom = NULL;
+
+    LOGDEBUG("[%s] spawning startup thread\n", instance->instanceId);
+    span = trace_begin("launch");
+    virConnectPtr conn = lock_hypervisor_query_conn();
+    if (conn == NULL) {
+        LOGERROR("[%s] could not contact the hypervisor, abandoning the instance\n", instance->instanceId);
+        goto shutoff;
+    }
+    unlock_hypervisor_query_conn(conn); // unlock right away, since we are just checking on it
+
+    // set up networking
+    if ((error = vnetStartNetwork(nc_state.vnetconfig, instance->ncnet.vlan, NULL, NULL, NULL, &brname)) != EUCA_OK) {
+        LOGERROR("[%s] start network failed for instance, terminating it\n", instance->instanceId);
+        EUCA_FREE(brname);
+        goto shutoff;
+    }
+    euca_strncpy(instance->params.guestNicDeviceName, brname, sizeof(instance->params.guestNicDeviceName));
+    EUCA_FREE(brname);
+
+    // set parameters like hypervisor type, bitness, NIC type, key injection, etc.
+    set_instance_params(instance);
+
+    entered = enter_launch_stage(instance, LAUNCH_FETCH, &stage_span);
+    error = create_instance_backing(instance, FALSE);   // do the heavy lifting on the disk
+    leave_launch_stage(instance, LAUNCH_FETCH, entered, stage_span);
+    if (error) {
+        LOGERROR("[%s] failed to prepare images for instance (error=%d)\n", instance->instanceId, error);
+        goto shutoff;
+    }
+
+    entered = enter_launch_stage(instance, LAUNCH_PREPARE, &stage_span);
+    if ((error = sync_instance_struct(instance))    // create euca-specific instance XML file
+        || (error = gen_libvirt_instance_xml(instance))) {  // transform euca-specific XML into libvirt XML
+        LOGERROR("[%s] failed to prepare images for instance (error=%d)\n", instance->instanceId, error);
+        leave_launch_stage(instance, LAUNCH_PREPARE, entered, stage_span);
+        goto shutoff;
+    }
+
+    if (instance->state == TEARDOWN) { // timed out in STAGING
+        leave_launch_stage(instance, LAUNCH_PREPARE, entered, stage_span);
+        goto free;
+    }
+
+    if (instance->state == CANCELED) {
+        LOGERROR("[%s] cancelled instance startup\n", instance->instanceId);
+        leave_launch_stage(instance, LAUNCH_PREPARE, entered, stage_span);
+        goto shutoff;
+    }
+
+    if (call_hooks(NC_EVENT_PRE_BOOT, instance->instancePath)) {
+        LOGERROR("[%s] cancelled instance startup via hooks\n", instance->instanceId);
+        leave_launch_stage(instance, LAUNCH_PREPARE, entered, stage_span);
+        goto shutoff;
+    }
+
+    xml = file2str(instance->libvirtFilePath);
+
+    sync_instance_struct(instance);    // to enable NC recovery, so it must be on disk before the domain exists
+    sensor_add_resource(instance->instanceId, "instance", instance->uuid);
+    sensor_set_resource_alias(instance->instanceId, instance->ncnet.privateIp);
+    update_disk_aliases(instance);
+    leave_launch_stage(instance, LAUNCH_PREPARE, entered, stage_span);
+
+    // serialize domain creation as hypervisors can get confused with
+    // too many simultaneous create requests
+    LOGTRACE("[%s] instance about to boot\n", instance->instanceId);
+
+    entered = enter_launch_stage(instance, LAUNCH_DEFINE, &stage_span);
+    for (i = 0; i < MAX_CREATE_TRYS; i++) { // retry loop
+        if (i > 0) {
+            LOGINFO("[%s] attempt %d of %d to create the instance\n", instance->instanceId, i + 1, MAX_CREATE_TRYS);
+        }
+
+        {                              // all this is done while holding the hypervisor lock, with a valid connection
+            virConnectPtr conn = lock_hypervisor_conn();
+            if (conn == NULL) {        // get a new connection for each loop iteration
+                LOGERROR("[%s] could not contact the hypervisor, abandoning the instance\n", instance->instanceId);
+                leave_launch_stage(instance, LAUNCH_DEFINE, entered, stage_span);
+                goto shutoff;
+            }
+
+            sem_p(loop_sem);
+
+            // We have seen virDomainCreateLinux() on occasion block indefinitely,
+            // which freezes all activity on the NC since hyp_sem and loop_sem are
+            // being held by the thread. (This is on Lucid with AppArmor enabled.)
+            // To protect against that, we invoke the function in a process and
+            // terminate it after CREATE_TIMEOUT_SEC seconds.
+            //
+            // #0  0x00007f359f0b1f93 in poll () from /lib/libc.so.6
+            // #1  0x00007f359a9a44e2 in ?? () from /usr/lib/libvirt.so.0
+            // #2  0x00007f359a9a5060 in ?? () from /usr/lib/libvirt.so.0
+            // #3  0x00007f359a9ac159 in ?? () from /usr/lib/libvirt.so.0
+            // #4  0x00007f359a98d65b in virDomainCreateXML () from /usr/lib/libvirt.so.0
+            // #5  0x00007f359b053c8e in startup_thread (arg=0x7f358813bf40) at handlers.c:644
+            // #6  0x00007f359f3619ca in start_thread () from /lib/libpthread.so.0
+            // #7  0x00007f359f0be70d in clone () from /lib/libc.so.6
+            // #8  0x0000000000000000 in ?? ()
+
+            if ((cpid = fork()) < 0) { // fork error
+                LOGERROR("[%s] failed to fork to start instance\n", instance->instanceId);
+            } else if (cpid == 0) {    // child process - creates the domain
+                if ((dom = virDomainCreateLinux(conn, xml, 0)) != NULL) {
+                    virDomainFree(dom); // To be safe. Docs are not clear on whether the handle exists outside the process.
+
+                    if (!strcmp(nc_state.vnetconfig->mode, NETMODE_VPCMIDO)) {
+                        char iface[16], cmd[EUCA_MAX_PATH], obuf[256], ebuf[256];
+                        snprintf(iface, 16, "vn_%s", instance->instanceId);
+                        snprintf(cmd, EUCA_MAX_PATH, "%s brctl delif %s %s", nc_state.rootwrap_cmd_path, instance->params.guestNicDeviceName, iface);
+                        rc = timeshell(cmd, obuf, ebuf, 256, 10);
+                        if (rc) {
+                            LOGERROR("unable to remove instance interface from bridge after launch: instance will not be able to connect to midonet (will not connect to network): check bridge/libvirt/kvm health\n");
                         }
                     }
+
+                    exit(0);
+                } else {
+                    exit(1);
+                }
+            } else {
+                // parent process - waits for the child, kills it if necessary
+                try_killing = FALSE;
+                if ((rc = timewait(cpid, &status, CREATE_TIMEOUT_SEC)) < 0) {
+                    LOGERROR("[%s] failed to wait for forked process: %s\n", instance->instanceId, strerror(errno));
+                    try_killing = TRUE;
+                } else if (rc == 0) {
+                    LOGERROR("[%s] timed out waiting for forked process pid=%d\n", instance->instanceId, cpid);
+                    try_killing = TRUE;
+                } else if (WEXITSTATUS(status) != 0) {
+                    LOGERROR("[%s] hypervisor failed to create the instance\n", instance->instanceId);
+                } else {
+                    created = TRUE;
+                }
+
+                if (try_killing) {
+                    killwait(cpid);
                 }
             }
 
-            if (strlen(ccHost)) {
-                fprintf(FP, "CCIP=%s\n", ccHost);
+            sem_v(loop_sem);
+            unlock_hypervisor_conn();  // guard against libvirtd connection badness
+        }
+
+        if (created)
+            break;
+        sleep(1);
+    }
+    leave_launch_stage(instance, LAUNCH_DEFINE, entered, stage_span);
+
+    if (!created) {
+        goto shutoff;
+    }
+
+    entered = enter_launch_stage(instance, LAUNCH_BOOT, &stage_span);
+    pull_lazy_disks(instance);
+    //! @TODO bring back correlationId
+    eventlog("NC", instance->userId, "", "instanceBoot", "begin");
+
+    {                                  // make instance state changes while under lock
+        sem_p(inst_sem);
+        // check one more time for cancellation
+        if (instance->state == TEARDOWN) {
+            // timed out in BOOTING
+        } else if (instance->state == CANCELED || instance->state == SHUTOFF) {
+            LOGERROR("[%s] startup of instance was cancelled\n", instance->instanceId);
+            change_state(instance, SHUTOFF);
+        } else {
+            LOGINFO("[%s] booting\n", instance->instanceId);
+            instance->bootTime = time(NULL);
+            change_state(instance, BOOTING);
+        }
+        copy_instances();
+        sem_v(inst_sem);
+    }
+    leave_launch_stage(instance, LAUNCH_BOOT, entered, stage_span);
+    goto free;
+
+shutoff:                              // escape point for error conditions
+    change_state(instance, SHUTOFF);
+    trace_end(span, TRUE);
+
+free:
+    trace_end(span, FALSE);            // nothing if already ended as failed
+    EUCA_FREE(xml);
+    EUCA_FREE(brname);
+    unset_corrid(get_corrid());
+    return NULL;
+}
+
+//!
+//! Has the hypervisor pull, in the background, the blocks that the guest has not read yet into
+//! the overlays of lazily booted disks, after which the instance no longer depends on the URLs
+//! of its images
+//!
+//! @param[in] instance pointer to the instance, whose domain has been created
+//!
+static void pull_lazy_disks(ncInstance * instance)
+{
+    virConnectPtr conn = NULL;
+    virDomainPtr dom = NULL;
+    virtualBootRecord *vbr = NULL;
+
+    for (int i = 0; ((i < EUCA_MAX_VBRS) && (i < instance->params.virtualBootRecordLen)); i++) {
+        vbr = &(instance->params.virtualBootRecord[i]);
+        if (strlen(vbr->backingFormat) == 0)
+            continue;
+        if (!nc_state.lazy_boot || (vbr->locationType != NC_LOCATION_URL))
+            continue;                  // overlays of compressed cached images keep reading from the cache
+
+        if (dom == NULL) {
+            if ((conn = lock_hypervisor_conn()) == NULL)
+                return;
+            if ((dom = virDomainLookupByName(conn, instance->instanceId)) == NULL) {
+                LOGWARN("[%s] failed to find the domain to pull its lazily booted disks\n", instance->instanceId);
+                unlock_hypervisor_conn();
+                return;
             }
+        }
 
-            if (strlen(clcHost)) {
-                fprintf(FP, "CLCIP=%s\n", clcHost);
+        if (virDomainBlockPull(dom, vbr->backingPath, nc_state.lazy_pull_bandwidth_mbs, 0) == 0) {
+            LOGINFO("[%s] pulling the rest of %s into %s\n", instance->instanceId, vbr->preparedResourceLocation, vbr->backingPath);
+        } else {
+            LOGWARN("[%s] failed to start pulling %s, so the instance keeps reading it on demand\n", instance->instanceId, vbr->preparedResourceLocation);
+        }
+    }
 
-                // See if we're in system mode, which in this case we have some work to do
-                if (!strcmp(nc_state.vnetconfig->mode, NETMODE_SYSTEM)) {
-                    ipHex = dot2hex(clcHost);
+    if (dom) {
+        virDomainFree(dom);
+        unlock_hypervisor_conn();
+    }
+}
 
-                    // don't change anything unless our cloud controller knowledge changed
-                    if (ipHex != nc_state.vnetconfig->cloudIp) {
-                        if (ipHex == 0) {
-                            // We lost the cloud controller IP, remove the metadata redirect first then
-                            // update vnetconfig second. The vnetUnsetMetadaRedirect() IP needs the old IP.
-                            // We only do this if we had a cloud IP set...
-                            if (nc_state.vnetconfig->cloudIp != 0) {
-                                if (vnetUnsetMetadataRedirect(nc_state.vnetconfig) == EUCA_OK) {
-                                    nc_state.vnetconfig->cloudIp = ipHex;
-                                    LOGDEBUG("Lost cloud controller IP information.\n");
+//!
+//! Defines the termination thread.
+//!
+//! @param[in] arg a transparent pointer to the argument passed to this thread handler
+//!
+//! @return Always return NULL
+//!
+void *terminating_thread(void *arg)
+{
+    char *instanceId = (char *)arg;
 
-                                    // now save our config
-                                    if (gen_nc_xml(&nc_state) != EUCA_OK) {
-                                        LOGERROR("failed to update NC state on disk after learning new cloud IP\n");
-                                    }
-                                } else {
-                                    LOGERROR("Failed to unset metadata redirect after CLC loss.");
-                                }
-                            }
-                        } else {
-                            LOGDEBUG("Learned new cloud controller IP %s.\n", clcHost);
+    LOGDEBUG("[%s] spawning terminating thread\n", instanceId);
 
-                            // HA, YAY!!! Cloud controller IP changed, remove our old metadata redirect and
-                            // then update the IP and re-install the rule with the new IP.
-                            if (vnetUnsetMetadataRedirect(nc_state.vnetconfig) == EUCA_OK) {
-                                nc_state.vnetconfig->cloudIp = ipHex;
-                                vnetSetMetadataRedirect(nc_state.vnetconfig);
+    int err = find_and_terminate_instance(instanceId);
+    if (err != EUCA_OK) {
+        goto free;
+    }
 
-                                // now save our config
-                                if (gen_nc_xml(&nc_state) != EUCA_OK) {
-                                    LOGERROR("failed to update NC state on disk after learning new cloud IP\n");
-                                }
-                            } else {
-                                LOGERROR("Failed to unset metadata redirect after CLC IP change.");
-                            }
-                        }
-                    }
-                }
+    {
+        sem_p(inst_sem);
+        ncInstance *instance = find_instance(&global_instances, instanceId);
+        if (instance == NULL) {
+            sem_v(inst_sem);
+            goto free;
+        }
+        // change the state and let the monitoring_thread clean up state
+        if (instance->state != TEARDOWN && instance->state != CANCELED) {
+            // do not leave TEARDOWN (cleaned up) or CANCELED (already trying to terminate)
+            if (instance->state == STAGING) {
+                change_state(instance, CANCELED);
+            } else {
+                change_state(instance, SHUTOFF);
             }
-            fflush(FP);
         }
+        copy_instances();
+        sem_v(inst_sem);
+    }
+free:
+    EUCA_FREE(arg);
+    unset_corrid(get_corrid());
+    return NULL;
+}
+
+//!
+//! Hands an instance over to the termination thread, which shuts down the domains of all the
+//! instances being terminated together, in one pass over the hypervisor connection every
+//! TERMINATION_POLL_PERIOD seconds, instead of each termination polling in its own thread.
+//! The termination thread is started on first use.
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+//! @return EUCA_OK if the instance will be terminated or EUCA_ERROR if the termination could
+//!         not be started.
+//!
+//! @see terminating_thread()
+//!
+int queue_termination(const char *instanceId)
+{
+    int i = 0;
+    int ret = EUCA_OK;
+    char *param = NULL;
+    pthread_t tid;
+    pthread_attr_t tattr;
+
+    pthread_mutex_lock(&terminations_mutex);
+    {
+        for (i = 0; (i < terminations_len) && strcmp(terminations[i].instanceId, instanceId); i++) ;
+        if (i < terminations_len) {
+            // already being terminated
+        } else if (terminations_len < MAXINSTANCES_PER_NC) {
+            euca_strncpy(terminations[terminations_len].instanceId, instanceId, sizeof(terminations[terminations_len].instanceId));
+            terminations[terminations_len].deadline = 0;
+            terminations_len++;
+            pthread_cond_signal(&terminations_cond);
+        } else {
+            ret = EUCA_ERROR;
+        }
+
+        if ((ret == EUCA_OK) && !termination_thread_running) {
+            pthread_attr_init(&tattr);
+            pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&tid, &tattr, termination_thread, NULL) != 0) {
+                LOGERROR("[%s] failed to start VM termination thread\n", instanceId);
+                terminations_len--;    // it is the last one
+                ret = EUCA_ERROR;
+            } else {
+                termination_thread_running = TRUE;
+            }
+            pthread_attr_destroy(&tattr);
+        }
+    }
+    pthread_mutex_unlock(&terminations_mutex);
+
+    if (ret != EUCA_OK) {
+        // fall back to a thread of its own
+        pthread_attr_init(&tattr);
+        pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+        if (((param = strdup(instanceId)) != NULL) && (pthread_create(&tid, &tattr, terminating_thread, (void *)param) == 0)) {
+            ret = EUCA_OK;
+        } else {
+            LOGERROR("[%s] failed to start VM termination thread\n", instanceId);
+            EUCA_FREE(param);
+        }
+        pthread_attr_destroy(&tattr);
+    }
 
-        cleaned_up = 0;
-        for (head = global_instances; head; head = head->next) {
-            instance = head->instance;
+    return (ret);
+}
 
-            // query for current state, if any
-            refresh_instance_info(nc, instance);
+//!
+//! Shuts down the domains of the instances handed over by queue_termination(), the same way
+//! shutdown_then_destroy_domain() does for one: each domain is first asked to shut down and
+//! is destroyed if it is still running after the shutdown grace period. Every pass goes over
+//! all the pending domains while holding the hypervisor connection once, and the states of
+//! the instances whose domains are gone are then updated under a single hold of inst_sem.
+//!
+//! @param[in] arg unused
+//!
+//! @return Always return NULL
+//!
+static void *termination_thread(void *arg)
+{
+    int i = 0;
+    int j = 0;
+    int len = 0;
+    int dom_status = 0;
+    time_t now = 0;
+    boolean done[MAXINSTANCES_PER_NC] = { FALSE };
+    int error[MAXINSTANCES_PER_NC] = { 0 };
+    pendingTermination batch[MAXINSTANCES_PER_NC];
+    struct timespec ts = { 0 };
+    virConnectPtr conn = NULL;
+    virDomainPtr dom = NULL;
+    ncInstance *instance = NULL;
 
-            // time out logic for migration-ready instances
-            if (!strcmp(instance->stateName, "Extant") && ((instance->migration_state == MIGRATION_READY) || (instance->migration_state == MIGRATION_PREPARING))
-                && ((now - instance->migrationTime) > nc_state.migration_ready_threshold)) {
-                if (instance->migrationTime) {
-                    if (outgoing_migrations_in_progress) {
-                        LOGINFO("[%s] has been in migration state '%s' on source for %d seconds (threshold is %d), but not rolling back due to %d ongoing outgoing migration[s]\n",
-                                instance->instanceId, migration_state_names[instance->migration_state], (int)(now - instance->migrationTime), nc_state.migration_ready_threshold,
-                                outgoing_migrations_in_progress);
-                        continue;
-                    }
+    LOGINFO("spawning termination thread\n");
 
-                    LOGWARN("[%s] has been in migration state '%s' on source for %d seconds (threshold is %d), rolling back [%d].\n",
-                            instance->instanceId, migration_state_names[instance->migration_state], (int)(now - instance->migrationTime), nc_state.migration_ready_threshold,
-                            instance->migrationTime);
-                    migration_rollback(instance);
+    for (;;) {
+        pthread_mutex_lock(&terminations_mutex);
+        {
+            while (terminations_len == 0)
+                pthread_cond_wait(&terminations_cond, &terminations_mutex);
+            len = terminations_len;
+            memcpy(batch, terminations, (len * sizeof(pendingTermination)));
+        }
+        pthread_mutex_unlock(&terminations_mutex);
+
+        if ((conn = lock_hypervisor_conn()) == NULL) {
+            LOGERROR("cannot connect to hypervisor to shut down %d instance(s)\n", len);
+            for (i = 0; i < len; i++) {
+                done[i] = TRUE;
+                error[i] = -1;
+            }
+        } else {
+            now = time(NULL);
+            for (i = 0; i < len; i++) {
+                done[i] = FALSE;
+                error[i] = 0;
+
+                if ((dom = virDomainLookupByName(conn, batch[i].instanceId)) == NULL) {
+                    // domain is gone, so we are done
+                    LOGTRACE("[%s] domain not found\n", batch[i].instanceId);
+                    done[i] = TRUE;
                     continue;
-                } else {
-                    if (instance->state == BOOTING) {
-                        // Assume destination node. (Is this a safe assumption?)
-                        LOGDEBUG("[%s] destination node ready: instance in booting state with no migrationTime.\n", instance->instanceId);
-                    } else {
-                        LOGWARN("[%s] in instance state '%s' is ready to migrate but has a zero instance migrationTime.\n",
-                                instance->instanceId, instance_state_names[instance->state]);
-                        migration_rollback(instance);
-                    }
                 }
-            }
-            // don't touch running or canceled threads
-            if (instance->state != STAGING && instance->state != BOOTING &&
-                instance->state != SHUTOFF &&
-                instance->state != SHUTDOWN &&
-                instance->state != BUNDLING_SHUTDOWN &&
-                instance->state != BUNDLING_SHUTOFF && instance->state != CREATEIMAGE_SHUTDOWN && instance->state != CREATEIMAGE_SHUTOFF && instance->state != TEARDOWN) {
 
-                if (FP && !strcmp(instance->stateName, "Extant")) {
-                    //! @TODO is this still being used?
-                    //! @TODO yes! for EDGE networking
-                    // have a running instance, write its information to local state file
-                    fprintf(FP, "%s %s %s %d %s %s %s\n",
-                            SP(instance->instanceId), SP(nc_state.vnetconfig->pubInterface), "NA", instance->ncnet.vlan, SP(instance->ncnet.privateMac),
-                            SP(instance->ncnet.publicIp), SP(instance->ncnet.privateIp));
-                    fflush(FP);
+                if (batch[i].deadline == 0) {
+                    // give OS a chance to shut down cleanly
+                    LOGDEBUG("[%s] shutting down instance\n", batch[i].instanceId);
+                    batch[i].deadline = now + nc_state.shutdown_grace_period_sec;
+                    if ((error[i] = virDomainShutdown(dom)) != 0)
+                        batch[i].deadline = now;
+                } else if (now < batch[i].deadline) {
+                    // within grace period - check on domain
+                    dom_status = virDomainIsActive(dom);
+                    LOGTRACE("[%s] domain status '%d'\n", batch[i].instanceId, dom_status);
+                    if (dom_status != 1) // 1 if running, 0 if inactive, -1 on error
+                        done[i] = TRUE;
                 }
-                continue;
-            }
 
-            if (instance->state == TEARDOWN) {
-                // it's been long enough, we can forget the instance
-                if ((now - instance->terminationTime) > nc_state.teardown_state_duration) {
-                    remove_instance(&global_instances, instance);
-                    LOGINFO("[%s] forgetting about instance\n", instance->instanceId);
-                    free_instance(&instance);
-                    break;             // need to get out since the list changed
+                if (!done[i] && (now >= batch[i].deadline)) {
+                    LOGDEBUG("[%s] destroying instance\n", batch[i].instanceId);
+                    error[i] = virDomainDestroy(dom);
+                    done[i] = TRUE;
                 }
-                continue;
+                virDomainFree(dom);
             }
-            // time out logic for STAGING or BOOTING or BUNDLING instances
-            if (instance->state == STAGING && (now - instance->launchTime) < nc_state.staging_cleanup_threshold)
-                continue;              // hasn't been long enough, spare it
-
-            if (instance->state == BOOTING && (now - instance->bootTime) < nc_state.booting_cleanup_threshold)
-                continue;
-
-            if ((instance->state == BUNDLING_SHUTDOWN || instance->state == BUNDLING_SHUTOFF)
-                && (now - instance->bundlingTime) < nc_state.bundling_cleanup_threshold)
-                continue;
+            unlock_hypervisor_conn();
+        }
 
-            if ((instance->state == CREATEIMAGE_SHUTDOWN || instance->state == CREATEIMAGE_SHUTOFF)
-                && (now - instance->createImageTime) < nc_state.createImage_cleanup_threshold)
-                continue;
+        // forget the finished ones; new entries may have been appended meanwhile
+        pthread_mutex_lock(&terminations_mutex);
+        {
+            for (i = 0, j = 0; i < terminations_len; i++) {
+                if ((i < len) && done[i])
+                    continue;
+                terminations[j] = terminations[i];
+                if (i < len)
+                    terminations[j].deadline = batch[i].deadline;
+                j++;
+            }
+            terminations_len = j;
+        }
+        pthread_mutex_unlock(&terminations_mutex);
 
-            // terminate a booting instance as a special case, though not if it's an incoming migration
-            if (instance->state == BOOTING) {
-                if ((instance->migration_state == MIGRATION_PREPARING) || (instance->migration_state == MIGRATION_READY)) {
-                    LOGDEBUG("[%s] instance has exceeded BOOTING cleanup threshold of %d seconds, but has migration_state=%s, so not terminating\n", instance->instanceId,
-                             nc_state.booting_cleanup_threshold, migration_state_names[instance->migration_state]);
+        // change the states and let the monitoring_thread clean up state
+        sem_p(inst_sem);
+        {
+            for (i = 0; i < len; i++) {
+                if (!done[i] || ((instance = find_instance(&global_instances, batch[i].instanceId)) == NULL))
                     continue;
+
+                // log the outcome at the appropriate log level
+                if (error[i] == 0) {
+                    LOGINFO("[%s] instance terminated\n", instance->instanceId);
+                } else if (instance->state != BOOTING && instance->state != STAGING && instance->state != TEARDOWN) {
+                    LOGERROR("[%s] failed to terminate instance\n", instance->instanceId);
                 } else {
-                    LOGDEBUG("[%s] finding and terminating BOOTING instance, which has exceeded cleanup threshold of %d seconds\n", instance->instanceId,
-                             nc_state.booting_cleanup_threshold);
+                    LOGDEBUG("[%s] failed to terminate instance\n", instance->instanceId);
+                }
 
-                    // do the shutdown in a thread
-                    pthread_attr_t tattr;
-                    pthread_t tid;
-                    pthread_attr_init(&tattr);
-                    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
-                    void *param = (void *)strdup(instance->instanceId);
-                    if (pthread_create(&tid, &tattr, terminating_thread, (void *)param) != 0) {
-                        LOGERROR("[%s] failed to start VM termination thread\n", instance->instanceId);
+                // do not leave TEARDOWN (cleaned up) or CANCELED (already trying to terminate)
+                if (instance->state != TEARDOWN && instance->state != CANCELED) {
+                    if (instance->state == STAGING) {
+                        change_state(instance, CANCELED);
+                    } else {
+                        change_state(instance, SHUTOFF);
                     }
                 }
             }
+            copy_instances();
+        }
+        sem_v(inst_sem);
 
-            if (cleaned_up < nc_state.concurrent_cleanup_ops) {
-                // ok, it's been condemned => destroy the files
-                cleaned_up++;
-                destroy_files = !nc_state.save_instance_files;
-                if (call_hooks(NC_EVENT_PRE_CLEAN, instance->instancePath)) {
-                    if (destroy_files) {
-                        LOGERROR("[%s] cancelled instance cleanup via hooks\n", instance->instanceId);
-                        destroy_files = 0;
-                    }
-                }
+        pthread_mutex_lock(&terminations_mutex);
+        {
+            if (terminations_len > 0) {
+                // sleep outside the hypervisor lock, waking up early if more terminations arrive
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += TERMINATION_POLL_PERIOD;
+                pthread_cond_timedwait(&terminations_cond, &terminations_mutex, &ts);
+            }
+        }
+        pthread_mutex_unlock(&terminations_mutex);
+    }
 
-                LOGINFO("[%s] cleaning up state for instance%s\n", instance->instanceId, (destroy_files) ? ("") : (" (but keeping the files)"));
-                if (destroy_instance_backing(instance, destroy_files)) {
-                    LOGWARN("[%s] failed to cleanup instance state\n", instance->instanceId);
-                }
-                // check to see if this is the last instance running on vlan, handle local networking information drop
-                left = 0;
-                for (vnhead = global_instances; vnhead; vnhead = vnhead->next) {
-                    vninstance = vnhead->instance;
-                    if (vninstance->ncnet.vlan == (instance->ncnet).vlan && strcmp(instance->instanceId, vninstance->instanceId)) {
-                        left++;
-                    }
-                }
-                if (left == 0) {
-                    LOGINFO("[%s] stopping the network (vlan=%d)\n", instance->instanceId, (instance->ncnet).vlan);
-                    vnetStopNetwork(nc_state.vnetconfig, (instance->ncnet).vlan, NULL, NULL);
-                }
+    return NULL;
+}
+
+//!
+//! Drops the local network of an instance if no other instance uses its vlan.
+//!
+//! @param[in] instance a pointer to the instance
+//!
+//! @pre The caller must hold inst_sem.
+//!
+static void stop_instance_network(ncInstance * instance)
+{
+    int left = 0;
+    bunchOfInstances *vnhead = NULL;
+    ncInstance *vninstance = NULL;
+
+    // check to see if this is the last instance running on vlan, handle local networking information drop
+    for (vnhead = global_instances; vnhead; vnhead = vnhead->next) {
+        vninstance = vnhead->instance;
+        if (vninstance->ncnet.vlan == (instance->ncnet).vlan && strcmp(instance->instanceId, vninstance->instanceId)) {
+            left++;
+        }
+    }
+    if (left == 0) {
+        LOGINFO("[%s] stopping the network (vlan=%d)\n", instance->instanceId, (instance->ncnet).vlan);
+        vnetStopNetwork(nc_state.vnetconfig, (instance->ncnet).vlan, NULL, NULL);
+    }
+}
+
+//!
+//! Destroys the backing of a batch of condemned instances, which the monitoring thread hands
+//! over so that it does not hold inst_sem, and block launches, while volumes are detached and
+//! blobs deleted. The instances are moved to TEARDOWN once their backing is gone.
+//!
+//! @param[in] arg a pointer to the cleanupBatch, which is freed here
+//!
+//! @return Always return NULL
+//!
+static void *cleanup_thread(void *arg)
+{
+    int i = 0;
+    cleanupBatch *batch = (cleanupBatch *) arg;
+    ncInstance *instance = NULL;
+
+    for (i = 0; i < batch->len; i++) {
+        instance = batch->instances[i];
+        LOGINFO("[%s] cleaning up state for instance%s\n", instance->instanceId, (batch->destroy_files[i]) ? ("") : (" (but keeping the files)"));
+        if (destroy_instance_backing(instance, batch->destroy_files[i])) {
+            LOGWARN("[%s] failed to cleanup instance state\n", instance->instanceId);
+        }
+    }
+
+    sem_p(inst_sem);
+    {
+        for (i = 0; i < batch->len; i++) {
+            if ((instance = find_instance(&global_instances, batch->instances[i]->instanceId)) != NULL) {
+                stop_instance_network(instance);
                 change_state(instance, TEARDOWN);   // TEARDOWN = no more resources
                 instance->terminationTime = time(NULL);
             }
+            free_instance(&(batch->instances[i]));
         }
+        cleanup_batch = NULL;
+        copy_instances();
+    }
+    sem_v(inst_sem);
 
-        if (FP) {
-            fclose(FP);
-            rename(nfile, nfilefinal);
-        }
+    EUCA_FREE(batch);
+    return NULL;
+}
 
-        copy_instances();              // copy global_instances to global_instances_copy
-        sem_v(inst_sem);
+//!
+//! Adopts one domain found running on the hypervisor at startup, if it is one of our instances.
+//! Called concurrently by the adoption workers, so the hypervisor is queried on the shared
+//! query connection and global_instances is only touched under inst_sem.
+//!
+//! @param[in] dom_id the hypervisor ID of the domain
+//!
+static void adopt_domain(int dom_id)
+{
+    int error = 0;
+    int err = 0;
+    virDomainInfo info = { 0 };
+    const char *name = NULL;
+    char dom_name[CHAR_BUFFER_SIZE] = "";
+    ncInstance *instance = NULL;
+    virDomainPtr dom = NULL;
+    virConnectPtr conn = NULL;
 
-        if (head) {
-            // we got out because of modified list, no need to sleep now
-            continue;
-        }
+    if ((conn = lock_hypervisor_query_conn()) == NULL) {
+        LOGWARN("failed to contact the hypervisor about running domain #%d, ignoring it\n", dom_id);
+        return;
+    }
+    // WARNING: be sure to call virDomainFree when necessary so as to avoid leaking the virDomainPtr
+    dom = virDomainLookupByID(conn, dom_id);
+    if (!dom) {
+        LOGWARN("failed to lookup running domain #%d, ignoring it\n", dom_id);
+        unlock_hypervisor_query_conn(conn);
+        return;
+    }
+    error = virDomainGetInfo(dom, &info);
+    if ((error < 0) || (info.state == VIR_DOMAIN_NOSTATE)) {
+        LOGWARN("failed to get info on running domain #%d, ignoring it\n", dom_id);
+    } else if (info.state == VIR_DOMAIN_SHUTDOWN || info.state == VIR_DOMAIN_SHUTOFF || info.state == VIR_DOMAIN_CRASHED) {
+        LOGDEBUG("ignoring non-running domain #%d\n", dom_id);
+    } else if ((name = virDomainGetName(dom)) == NULL) {
+        LOGWARN("failed to get name of running domain #%d, ignoring it\n", dom_id);
+    } else {
+        euca_strncpy(dom_name, name, sizeof(dom_name));
+    }
+    virDomainFree(dom);
+    unlock_hypervisor_query_conn(conn);
 
-        sleep(MONITORING_PERIOD);
+    if ((dom_name[0] == '\0') || !strcmp(dom_name, "Domain-0"))
+        return;
 
-        // do this on every iteration (every MONITORING_PERIOD seconds)
-        if ((iteration % 1) == 0) {
-            // see if config file has changed and react to those changes
-            if (isConfigModified(nc_state.configFiles, 2) > 0) {    // config modification time has changed
-                if (readConfigFile(nc_state.configFiles, 2)) {
-                    // something has changed that can be read in
-                    LOGINFO("configuration file has been modified, ingressing new options\n");
+    if ((instance = load_instance_struct(dom_name)) == NULL) {
+        LOGWARN("failed to recover Eucalyptus metadata of running domain %s, ignoring it\n", dom_name);
+        return;
+    }
 
-                    // log-related options
-                    update_log_params();
+    if (call_hooks(NC_EVENT_ADOPTING, instance->instancePath)) {
+        LOGINFO("[%s] ignoring running domain due to hooks\n", instance->instanceId);
+        free_instance(&instance);
+        return;
+    }
 
-                    // EBS-related options
-                    update_ebs_params();
+    change_state(instance, info.state);
+    sem_p(inst_sem);
+    {
+        err = add_instance(&global_instances, instance);
+    }
+    sem_v(inst_sem);
 
-                    //! @todo pick up other NC options dynamically?
-                }
-            }
-        }
-        // do this every 10th iteration (every 10*MONITORING_PERIOD seconds)
-        if ((iteration % 10) == 0) {
-            //! @todo 3.2 change 1 to 10
+    if (err) {
+        free_instance(&instance);
+        return;
+    }
 
-            // check file system state and blobstore state
-            blobstore_meta work_meta, cache_meta;
-            if (stat_backing_store(NULL, &work_meta, &cache_meta) == EUCA_OK) {
-                work_fs_size_mb = (long long)(work_meta.fs_bytes_size / MEGABYTE);
-                work_fs_avail_mb = (long long)(work_meta.fs_bytes_available / MEGABYTE);
-                cache_fs_size_mb = (long long)(cache_meta.fs_bytes_size / MEGABYTE);
-                cache_fs_avail_mb = (long long)(cache_meta.fs_bytes_available / MEGABYTE);
+    sensor_add_resource(instance->instanceId, "instance", instance->uuid);  // ensure the sensor system monitors this instance
+    sensor_set_resource_alias(instance->instanceId, instance->ncnet.privateIp);
+    update_disk_aliases(instance);
+
+    //! @TODO try to re-check IPs?
+    LOGINFO("[%s] - adopted running domain from user %s\n", instance->instanceId, instance->userId);
+}
+
+//!
+//! Adoption worker, which adopts domains from the queue until it is empty
+//!
+//! @param[in] arg a pointer to the adoptionQueue
+//!
+//! @return Always return NULL
+//!
+static void *adopting_thread(void *arg)
+{
+    int i = 0;
+    adoptionQueue *queue = ((adoptionQueue *) arg);
+
+    for (;;) {
+        pthread_mutex_lock(&(queue->mutex));
+        i = queue->next++;
+        pthread_mutex_unlock(&(queue->mutex));
+        if (i >= queue->num_doms)
+            break;
+        adopt_domain(queue->dom_ids[i]);
+    }
+    return (NULL);
+}
+
+//!
+//! On startup, adopt instance found running on the hypervisor. Loading the metadata of each
+//! instance and running the adoption hooks take a while, so up to ADOPTION_WORKERS domains
+//! are adopted at once.
+//!
+void adopt_instances()
+{
+    int i = 0;
+    int workers = 0;
+    adoptionQueue *queue = NULL;
+    virConnectPtr conn = NULL;
+    pthread_t threads[ADOPTION_WORKERS] = { 0 };
+
+    if ((queue = EUCA_ZALLOC(1, sizeof(adoptionQueue))) == NULL) {
+        LOGERROR("out of memory, not adopting running domains\n");
+        return;
+    }
+    pthread_mutex_init(&(queue->mutex), NULL);
+
+    if ((conn = lock_hypervisor_query_conn()) == NULL) {
+        EUCA_FREE(queue);
+        return;
+    }
+
+    LOGINFO("looking for existing domains\n");
+    virSetErrorFunc(NULL, libvirt_err_handler);
 
-                if (work_fs_avail_mb < ((work_fs_size_mb * DISK_TOO_LOW_PERCENT) / 100)) {
-                    log_eucafault("1003", "component", euca_this_component_name, "file", work_meta.path, NULL);
-                }
+    queue->num_doms = virConnectListDomains(conn, queue->dom_ids, MAXDOMS);
+    unlock_hypervisor_query_conn(conn);
+    if (queue->num_doms == 0) {
+        LOGINFO("no currently running domains to adopt\n");
+        EUCA_FREE(queue);
+        return;
+    }
+    if (queue->num_doms < 0) {
+        LOGWARN("failed to find out about running domains\n");
+        EUCA_FREE(queue);
+        return;
+    }
 
-                if (cache_fs_size_mb > 0 && cache_fs_avail_mb < ((cache_fs_size_mb * DISK_TOO_LOW_PERCENT) / 100)) {
-                    log_eucafault("1003", "component", euca_this_component_name, "file", cache_meta.path, NULL);
-                }
-                //! @todo add more faults (cache or work reserved exceeds available space on file system)
-            }
+    for (i = 0; (i < ADOPTION_WORKERS) && (i < queue->num_doms); i++) {
+        if (pthread_create(&(threads[workers]), NULL, adopting_thread, queue) != 0) {
+            LOGWARN("failed to start adoption worker %d\n", i);
+            continue;
         }
+        workers++;
     }
+    if (workers == 0)
+        adopting_thread(queue);        // adopt them all in this thread, then
+    for (i = 0; i < workers; i++)
+        pthread_join(threads[i], NULL);
+    LOGINFO("examined %d running domain(s) with %d worker(s)\n", queue->num_doms, workers);
 
-    return NULL;
+    pthread_mutex_destroy(&(queue->mutex));
+    EUCA_FREE(queue);
 
-#undef EUCANETD_PID_FILE
-#undef EUCANETD_SERVICE_NAME
+    sem_p(inst_sem);
+    {
+        copy_instances();              // publish a snapshot of global_instances
+    }
+    sem_v(inst_sem);
 }
 
 //!
-//! Fills in some of the fields of instance struct
 //!
-//! @param[in] instance struct to fill in
 //!
-void set_instance_params(ncInstance * instance)
+//! @param[in] sig
+//!
+static void nc_signal_handler(int sig)
 {
-    char *s = NULL;
+    LOGDEBUG("signal handler caught %d\n", sig);
+}
 
-    if (nc_state.config_use_virtio_net) {
-        instance->params.nicType = NIC_TYPE_VIRTIO;
-    } else {
-        if (strstr(instance->platform, "windows")) {
-            instance->params.nicType = NIC_TYPE_WINDOWS;
-        } else {
-            instance->params.nicType = NIC_TYPE_LINUX;
-        }
-    }
+#define GET_VAR_INT(_var, _name, _def)                   \
+{                                                        \
+	s = getConfString(nc_state.configFiles, 2, (_name)); \
+	if (s) {					                         \
+		(_var) = atoi(s);                                \
+		EUCA_FREE(s);                                    \
+	} else {                                             \
+		(_var) = (_def);                                 \
+	}                                                    \
+}
 
-    euca_strncpy(instance->hypervisorType, nc_state.H->name, sizeof(instance->hypervisorType)); // set the hypervisor type
+//!
+//! Runs the steps of a stage of NC initialization at the same time, each in its own thread but
+//! the first, which runs in the calling one, and logs how long each took so that slow steps show
+//! up in the log.
+//!
+//! @param[in] stage name of the stage, for the logs
+//! @param[in,out] phases the steps of the stage
+//! @param[in] num_phases number of entries in phases
+//!
+//! @return EUCA_OK if all the steps succeeded, or the error of the first failed one
+//!
+static int run_init_phases(const char *stage, initPhase * phases, int num_phases)
+{
+    int i = 0;
+    int ret = EUCA_OK;
+    long long started = mono_time_usec();
 
-    instance->hypervisorCapability = nc_state.capability;   // set the cap (xen/hw/hw+xen)
-    if ((s = system_output("getconf LONG_BIT")) != NULL) {
-        int bitness = atoi(s);
-        if (bitness == 32 || bitness == 64) {
-            instance->hypervisorBitness = bitness;
-        } else {
-            LOGWARN("[%s] can't determine the host's bitness (%s, assuming 64)\n", instance->instanceId, s);
-            instance->hypervisorBitness = 64;
-        }
-        EUCA_FREE(s);
-    } else {
-        LOGWARN("[%s] can't determine the host's bitness (assuming 64)\n", instance->instanceId);
-        instance->hypervisorBitness = 64;
+    for (i = 1; i < num_phases; i++) {
+        phases[i].spawned = (pthread_create(&(phases[i].thread), NULL, init_phase_thread, &(phases[i])) == 0);
     }
-    instance->combinePartitions = nc_state.convert_to_disk;
-    instance->do_inject_key = nc_state.do_inject_key;
+    init_phase_thread(&(phases[0]));
+    for (i = 1; i < num_phases; i++) {
+        if (phases[i].spawned)
+            pthread_join(phases[i].thread, NULL);
+        else
+            init_phase_thread(&(phases[i]));    // no thread for it, run it here then
+    }
+
+    for (i = 0; i < num_phases; i++) {
+        LOGINFO("init: %s took %lld ms%s\n", phases[i].name, (phases[i].usec / 1000), ((phases[i].result == EUCA_OK) ? "" : ", failed"));
+        if ((ret == EUCA_OK) && (phases[i].result != EUCA_OK))
+            ret = phases[i].result;
+    }
+    LOGINFO("init: %s stage took %lld ms\n", stage, ((mono_time_usec() - started) / 1000));
+    return (ret);
 }
 
 //!
-//! Defines the instance startup thread
+//! Runs and times one step of NC initialization, see run_init_phases()
 //!
-//! @param[in] arg a transparent pointer to the instance structure to start
+//! @param[in] arg a pointer to the initPhase
 //!
 //! @return Always return NULL
 //!
-void *startup_thread(void *arg)
+static void *init_phase_thread(void *arg)
 {
-    int i = 0;
-    int error = EUCA_OK;
-    int status = 0;
-    int rc = 0;
-    char *xml = NULL;
-    char *brname = NULL;
-    pid_t cpid = 0;
-    boolean try_killing = FALSE;
-    boolean created = FALSE;
-    ncInstance *instance = ((ncInstance *) arg);
-    virDomainPtr dom = NULL;
+    initPhase *phase = ((initPhase *) arg);
+    long long started = mono_time_usec();
 
-    LOGDEBUG("[%s] spawning startup thread\n", instance->instanceId);
-    virConnectPtr conn = lock_hypervisor_conn();
-    if (conn == NULL) {
-        LOGERROR("[%s] could not contact the hypervisor, abandoning the instance\n", instance->instanceId);
-        goto shutoff;
-    }
-    unlock_hypervisor_conn();          // unlock right away, since we are just checking on it
+    phase->result = phase->run();
+    phase->usec = mono_time_usec() - started;
+    return (NULL);
+}
 
-    // set up networking
-    if ((error = vnetStartNetwork(nc_state.vnetconfig, instance->ncnet.vlan, NULL, NULL, NULL, &brname)) != EUCA_OK) {
-        LOGERROR("[%s] start network failed for instance, terminating it\n", instance->instanceId);
-        EUCA_FREE(brname);
-        goto shutoff;
-    }
-    euca_strncpy(instance->params.guestNicDeviceName, brname, sizeof(instance->params.guestNicDeviceName));
-    EUCA_FREE(brname);
+//!
+//! Initialization step that sets up the hypervisor driver and connection and, from what they
+//! discover, the memory, cores and NUMA layout available to instances
+//!
+//! @return EUCA_OK on success or EUCA_FATAL_ERROR
+//!
+static int init_hypervisor_phase(void)
+{
+    int i = 0;
+    char *s = NULL;
 
-    // set parameters like hypervisor type, bitness, NIC type, key injection, etc.
-    set_instance_params(instance);
+    // must precede the first connection to the hypervisor, so that connections get keepalive
+    init_hypervisor_events();
 
-    if ((error = create_instance_backing(instance, FALSE))  // do the heavy lifting on the disk
-        || (error = gen_instance_xml(instance)) // create euca-specific instance XML file
-        || (error = gen_libvirt_instance_xml(instance))) {  // transform euca-specific XML into libvirt XML
-        LOGERROR("[%s] failed to prepare images for instance (error=%d)\n", instance->instanceId, error);
-        goto shutoff;
-    }
+    // NOTE: this is the only call which needs to be called on both
+    // the default and the specific handler! All the others will be
+    // either or
+    i = nc_state.D->doInitialize(&nc_state);
+    if (nc_state.H->doInitialize)
+        i += nc_state.H->doInitialize(&nc_state);
 
-    if (instance->state == TEARDOWN) { // timed out in STAGING
-        goto free;
+    if (i) {
+        LOGFATAL("failed to initialized hypervisor driver!\n");
+        return (EUCA_FATAL_ERROR);
     }
 
-    if (instance->state == CANCELED) {
-        LOGERROR("[%s] cancelled instance startup\n", instance->instanceId);
-        goto shutoff;
+    {
+        // check on hypervisor and pull out capabilities
+        virConnectPtr conn = lock_hypervisor_conn();
+        if (conn == NULL) {
+            LOGFATAL("unable to contact hypervisor\n");
+            return (EUCA_FATAL_ERROR);
+        }
+        char *caps_xml = virConnectGetCapabilities(conn);
+        if (caps_xml == NULL) {
+            LOGFATAL("unable to obtain hypervisor capabilities\n");
+            unlock_hypervisor_conn();
+            return (EUCA_FATAL_ERROR);
+        }
+        unlock_hypervisor_conn();
+        if (strstr(caps_xml, "<live/>") != NULL) {
+            nc_state.migration_capable = 1;
+        }
+        EUCA_FREE(caps_xml);
     }
+    LOGINFO("hypervisor %scapable of live migration\n", nc_state.migration_capable ? "" : "not ");
 
-    if (call_hooks(NC_EVENT_PRE_BOOT, instance->instancePath)) {
-        LOGERROR("[%s] cancelled instance startup via hooks\n", instance->instanceId);
-        goto shutoff;
+    // now that hypervisor-specific initializers have discovered mem_max and cores_max,
+    // adjust the values based on configuration parameters, if any
+    if (nc_state.config_max_mem) {
+        if (nc_state.config_max_mem > nc_state.mem_max)
+            LOGWARN("MAX_MEM value is set to %lldMB that is greater than the amount of physical memory: %lldMB\n", nc_state.config_max_mem, nc_state.mem_max);
+        nc_state.mem_max = nc_state.config_max_mem;
+    } else {
+        nc_state.mem_max = nc_state.phy_max_mem;
     }
 
-    xml = file2str(instance->libvirtFilePath);
+    if (nc_state.config_max_cores) {
+        int cores = nc_state.cores_max;
+        nc_state.cores_max = nc_state.config_max_cores;
+        if (nc_state.cores_max > MAXINSTANCES_PER_NC) {
+            nc_state.cores_max = MAXINSTANCES_PER_NC;
+            LOGWARN("ignoring excessive MAX_CORES value (leaving at %lld)\n", nc_state.cores_max);
+        }
 
-    save_instance_struct(instance);    // to enable NC recovery
-    sensor_add_resource(instance->instanceId, "instance", instance->uuid);
-    sensor_set_resource_alias(instance->instanceId, instance->ncnet.privateIp);
-    update_disk_aliases(instance);
+        if (nc_state.cores_max > cores)
+            LOGWARN("MAX_CORES value is set to %lld that is greater than the amount of physical cores: %d\n", nc_state.cores_max, cores);
+    } else {
+        nc_state.cores_max = nc_state.phy_max_cores;
+    }
 
-    // serialize domain creation as hypervisors can get confused with
-    // too many simultaneous create requests
-    LOGTRACE("[%s] instance about to boot\n", instance->instanceId);
+    LOGINFO("physical memory available for instances: %lldMB\n", nc_state.mem_max);
+    LOGINFO("virtual cpu cores available for instances: %lld\n", nc_state.cores_max);
 
-    for (i = 0; i < MAX_CREATE_TRYS; i++) { // retry loop
-        if (i > 0) {
-            LOGINFO("[%s] attempt %d of %d to create the instance\n", instance->instanceId, i + 1, MAX_CREATE_TRYS);
+    {
+        // NUMA placement and huge page backing of instances
+        char *huge_pages = NULL;
+
+        GET_VAR_INT(nc_state.numa_pinning, CONFIG_NUMA_PINNING, 0);
+        nc_state.huge_pages_kb = 0;
+        if ((huge_pages = getConfString(nc_state.configFiles, 2, CONFIG_HUGE_PAGES)) != NULL) {
+            if (!strcasecmp(huge_pages, "2M")) {
+                nc_state.huge_pages_kb = 2048;
+            } else if (!strcasecmp(huge_pages, "1G")) {
+                nc_state.huge_pages_kb = 1048576;
+            } else if (strlen(huge_pages) > 0) {
+                LOGWARN("ignoring unsupported %s value '%s' (supported: 2M, 1G)\n", CONFIG_HUGE_PAGES, huge_pages);
+            }
+            EUCA_FREE(huge_pages);
         }
-
-        {                              // all this is done while holding the hypervisor lock, with a valid connection
-            virConnectPtr conn = lock_hypervisor_conn();
-            if (conn == NULL) {        // get a new connection for each loop iteration
-                LOGERROR("[%s] could not contact the hypervisor, abandoning the instance\n", instance->instanceId);
-                goto shutoff;
+        if (nc_state.huge_pages_kb) {
+            char path[EUCA_MAX_PATH] = "";
+            snprintf(path, sizeof(path), "/sys/kernel/mm/hugepages/hugepages-%dkB", nc_state.huge_pages_kb);
+            if (check_directory(path)) {
+                LOGWARN("the host has no %dkB huge pages, instance memory will not be backed by huge pages\n", nc_state.huge_pages_kb);
+                nc_state.huge_pages_kb = 0;
             }
+        }
+        init_numa_topology();
+        init_memory_density();
+    }
+    return (EUCA_OK);
+}
 
-            sem_p(loop_sem);
-
-            // We have seen virDomainCreateLinux() on occasion block indefinitely,
-            // which freezes all activity on the NC since hyp_sem and loop_sem are
-            // being held by the thread. (This is on Lucid with AppArmor enabled.)
-            // To protect against that, we invoke the function in a process and
-            // terminate it after CREATE_TIMEOUT_SEC seconds.
-            //
-            // #0  0x00007f359f0b1f93 in poll () from /lib/libc.so.6
-            // #1  0x00007f359a9a44e2 in ?? () from /usr/lib/libvirt.so.0
-            // #2  0x00007f359a9a5060 in ?? () from /usr/lib/libvirt.so.0
-            // #3  0x00007f359a9ac159 in ?? () from /usr/lib/libvirt.so.0
-            // #4  0x00007f359a98d65b in virDomainCreateXML () from /usr/lib/libvirt.so.0
-            // #5  0x00007f359b053c8e in startup_thread (arg=0x7f358813bf40) at handlers.c:644
-            // #6  0x00007f359f3619ca in start_thread () from /lib/libpthread.so.0
-            // #7  0x00007f359f0be70d in clone () from /lib/libc.so.6
-            // #8  0x0000000000000000 in ?? ()
-
-            if ((cpid = fork()) < 0) { // fork error
-                LOGERROR("[%s] failed to fork to start instance\n", instance->instanceId);
-            } else if (cpid == 0) {    // child process - creates the domain
-                if ((dom = virDomainCreateLinux(conn, xml, 0)) != NULL) {
-                    virDomainFree(dom); // To be safe. Docs are not clear on whether the handle exists outside the process.
+//!
+//! Initialization step that sizes and opens the work and cache blobstores of the backing store
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include EUCA_ERROR,
+//!         EUCA_FATAL_ERROR
+//!
+static int init_backing_phase(void)
+{
+    char *s = NULL;
 
-                    if (!strcmp(nc_state.vnetconfig->mode, NETMODE_VPCMIDO)) {
-                        char iface[16], cmd[EUCA_MAX_PATH], obuf[256], ebuf[256];
-                        snprintf(iface, 16, "vn_%s", instance->instanceId);
-                        snprintf(cmd, EUCA_MAX_PATH, "%s brctl delif %s %s", nc_state.rootwrap_cmd_path, instance->params.guestNicDeviceName, iface);
-                        rc = timeshell(cmd, obuf, ebuf, 256, 10);
-                        if (rc) {
-                            LOGERROR("unable to remove instance interface from bridge after launch: instance will not be able to connect to midonet (will not connect to network): check bridge/libvirt/kvm health\n");
-                        }
-                    }
+    // backing store configuration
+    char *instances_path = getConfString(nc_state.configFiles, 2, INSTANCE_PATH);
 
-                    exit(0);
-                } else {
-                    exit(1);
-                }
-            } else {
-                // parent process - waits for the child, kills it if necessary
-                try_killing = FALSE;
-                if ((rc = timewait(cpid, &status, CREATE_TIMEOUT_SEC)) < 0) {
-                    LOGERROR("[%s] failed to wait for forked process: %s\n", instance->instanceId, strerror(errno));
-                    try_killing = TRUE;
-                } else if (rc == 0) {
-                    LOGERROR("[%s] timed out waiting for forked process pid=%d\n", instance->instanceId, cpid);
-                    try_killing = TRUE;
-                } else if (WEXITSTATUS(status) != 0) {
-                    LOGERROR("[%s] hypervisor failed to create the instance\n", instance->instanceId);
+    if (instances_path == NULL) {
+        LOGERROR("%s is not set\n", INSTANCE_PATH);
+        return (EUCA_FATAL_ERROR);
+    }
+    // create work and cache sub-directories so that stat_backing_store() below succeeds
+    char cache_path[EUCA_MAX_PATH];
+    snprintf(cache_path, sizeof(cache_path), "%s/cache", instances_path);
+    if (ensure_directories_exist(cache_path, 0, NULL, NULL, BACKING_DIRECTORY_PERM) == -1) {
+        EUCA_FREE(instances_path);
+        return (EUCA_ERROR);
+    }
+
+    char work_path[EUCA_MAX_PATH];
+    snprintf(work_path, sizeof(work_path), "%s/work", instances_path);
+    if (ensure_directories_exist(work_path, 0, NULL, NULL, BACKING_DIRECTORY_PERM) == -1) {
+        EUCA_FREE(instances_path);
+        return (EUCA_ERROR);
+    }
+    // determine how much is used/available in work and cache areas on the backing store
+    blobstore_meta work_meta, cache_meta;
+    stat_backing_store(instances_path, &work_meta, &cache_meta);    // will zero-out work_ and cache_meta
+    long long work_fs_size_mb = (long long)(work_meta.fs_bytes_size / MEGABYTE);
+    long long work_fs_avail_mb = (long long)(work_meta.fs_bytes_available / MEGABYTE);
+    long long cache_fs_size_mb = (long long)(cache_meta.fs_bytes_size / MEGABYTE);
+    long long cache_fs_avail_mb = (long long)(cache_meta.fs_bytes_available / MEGABYTE);
+    long long work_bs_size_mb = work_meta.blocks_limit ? (work_meta.blocks_limit / SEC_PER_MB) : (-1L); // convert sectors->MB
+    long long work_bs_allocated_mb = work_meta.blocks_limit ? (work_meta.blocks_allocated / SEC_PER_MB) : 0;
+    long long work_bs_reserved_mb = work_meta.blocks_limit ? ((work_meta.blocks_locked + work_meta.blocks_unlocked) / SEC_PER_MB) : 0;
+    long long cache_bs_size_mb = cache_meta.blocks_limit ? (cache_meta.blocks_limit / SEC_PER_MB) : (-1L);
+    long long cache_bs_allocated_mb = cache_meta.blocks_limit ? (cache_meta.blocks_allocated / SEC_PER_MB) : 0;
+    long long cache_bs_reserved_mb = cache_meta.blocks_limit ? ((cache_meta.blocks_locked + cache_meta.blocks_unlocked) / SEC_PER_MB) : 0;
+
+    // sanity check
+    if (work_fs_avail_mb < MIN_BLOBSTORE_SIZE_MB) {
+        LOGERROR("insufficient available work space (%lld MB) under %s/work\n", work_fs_avail_mb, instances_path);
+        EUCA_FREE(instances_path);
+        return (EUCA_FATAL_ERROR);
+    }
+    // look up configuration file settings for work and cache size
+    long long conf_work_size_mb;
+    GET_VAR_INT(conf_work_size_mb, CONFIG_NC_WORK_SIZE, -1);
+
+    long long conf_cache_size_mb;
+    GET_VAR_INT(conf_cache_size_mb, CONFIG_NC_CACHE_SIZE, -1);
+
+    long long conf_work_overhead_mb;
+    GET_VAR_INT(conf_work_overhead_mb, CONFIG_NC_OVERHEAD_SIZE, PER_INSTANCE_BUFFER_MB);
+
+    {                              // accommodate legacy MAX_DISK setting by converting it
+        int max_disk_gb;
+        GET_VAR_INT(max_disk_gb, CONFIG_MAX_DISK, -1);
+        if (max_disk_gb != -1) {
+            if (conf_work_size_mb == -1) {
+                LOGWARN("using deprecated setting %s for the new setting %s\n", CONFIG_MAX_DISK, CONFIG_NC_WORK_SIZE);
+                if (max_disk_gb == 0) {
+                    conf_work_size_mb = -1; // change in semantics: 0 used to mean 'unlimited', now 'unset' or -1 means that
                 } else {
-                    created = TRUE;
+                    conf_work_size_mb = max_disk_gb * 1024;
                 }
+            } else {
+                LOGWARN("ignoring deprecated setting %s in favor of the new setting %s\n", CONFIG_MAX_DISK, CONFIG_NC_WORK_SIZE);
+            }
+        }
+    }
 
-                if (try_killing) {
-                    killwait(cpid);
-                }
+    // decide what work and cache sizes should be, based on all the inputs
+    long long work_size_mb = -1;
+    long long cache_size_mb = -1;
+
+    // above all, try to respect user-specified limits for work and cache
+    if (conf_work_size_mb != -1) {
+        if (conf_work_size_mb < MIN_BLOBSTORE_SIZE_MB) {
+            LOGWARN("ignoring specified work size (%s=%lld) that is below acceptable minimum (%d)\n", CONFIG_NC_WORK_SIZE, conf_work_size_mb, MIN_BLOBSTORE_SIZE_MB);
+        } else {
+            if (work_bs_size_mb != -1 && work_bs_size_mb != conf_work_size_mb) {
+                LOGWARN("specified work size (%s=%lld) differs from existing work size (%lld), will try resizing\n", CONFIG_NC_WORK_SIZE, conf_work_size_mb, work_bs_size_mb);
             }
+            work_size_mb = conf_work_size_mb;
+        }
+    }
 
-            sem_v(loop_sem);
-            unlock_hypervisor_conn();  // guard against libvirtd connection badness
+    if (conf_cache_size_mb != -1) { // respect user-specified limit
+        if (conf_cache_size_mb < MIN_BLOBSTORE_SIZE_MB) {
+            cache_size_mb = 0;     // so it won't be used
+        } else {
+            if (cache_bs_size_mb != -1 && cache_bs_size_mb != conf_cache_size_mb) {
+                LOGWARN("specified cache size (%s=%lld) differs from existing cache size (%lld), will try resizing\n",
+                        CONFIG_NC_CACHE_SIZE, conf_cache_size_mb, cache_bs_size_mb);
+            }
+            cache_size_mb = conf_cache_size_mb;
+        }
+    }
+    // if the user did not specify sizes, try existing blobstores,
+    // if any, whose limits would have been chosen earlier
+    if (work_size_mb == -1 && work_bs_size_mb != -1)
+        work_size_mb = work_bs_size_mb;
+
+    if (cache_size_mb == -1 && cache_bs_size_mb != -1)
+        cache_size_mb = cache_bs_size_mb;
+
+    // if the user did not specify either or both of the sizes,
+    // and blobstores do not exist yet, make reasonable choices
+    if (memcmp(&work_meta.fs_id, &cache_meta.fs_id, sizeof(fsid_t)) == 0) { // cache and work are on the same file system
+        long long fs_usable_mb = (long long)((double)work_fs_avail_mb - (double)(work_fs_avail_mb) * FS_BUFFER_PERCENT);
+        if (work_size_mb == -1 && cache_size_mb == -1) {
+            work_size_mb = (long long)((double)fs_usable_mb * WORK_BS_PERCENT);
+            cache_size_mb = fs_usable_mb - work_size_mb;
+        } else if (work_size_mb == -1) {
+            work_size_mb = fs_usable_mb - cache_size_mb + cache_bs_allocated_mb;
+        } else if (cache_size_mb == -1) {
+            cache_size_mb = fs_usable_mb - work_size_mb + work_bs_allocated_mb;
+        }
+        // sanity check
+        if ((cache_size_mb + work_size_mb - cache_bs_allocated_mb - work_bs_allocated_mb) > work_fs_avail_mb) {
+            LOGWARN("sum of work and cache sizes exceeds available disk space\n");
+        }
+    } else {                       // cache and work are on different file systems
+        if (work_size_mb == -1) {
+            work_size_mb = (long long)((double)work_fs_avail_mb - (double)(work_fs_avail_mb) * FS_BUFFER_PERCENT);
         }
 
-        if (created)
-            break;
-        sleep(1);
+        if (cache_size_mb == -1) {
+            cache_size_mb = (long long)((double)cache_fs_avail_mb - (double)(cache_fs_avail_mb) * FS_BUFFER_PERCENT);
+        }
     }
 
-    if (!created) {
-        goto shutoff;
+    // sanity-check final results
+    if (cache_size_mb < MIN_BLOBSTORE_SIZE_MB)
+        cache_size_mb = 0;
+
+    if (work_size_mb < MIN_BLOBSTORE_SIZE_MB) {
+        LOGERROR("insufficient disk space for virtual machines\n");
+        EUCA_FREE(instances_path);
+        return (EUCA_FATAL_ERROR);
     }
-    //! @TODO bring back correlationId
-    eventlog("NC", instance->userId, "", "instanceBoot", "begin");
 
-    {                                  // make instance state changes while under lock
-        sem_p(inst_sem);
-        // check one more time for cancellation
-        if (instance->state == TEARDOWN) {
-            // timed out in BOOTING
-        } else if (instance->state == CANCELED || instance->state == SHUTOFF) {
-            LOGERROR("[%s] startup of instance was cancelled\n", instance->instanceId);
-            change_state(instance, SHUTOFF);
-        } else {
-            LOGINFO("[%s] booting\n", instance->instanceId);
-            instance->bootTime = time(NULL);
-            change_state(instance, BOOTING);
-        }
-        copy_instances();
-        sem_v(inst_sem);
+    if (init_backing_store(instances_path, work_size_mb, cache_size_mb)) {
+        LOGFATAL("failed to initialize backing store\n");
+        EUCA_FREE(instances_path);
+        return (EUCA_FATAL_ERROR);
+    }
+    // share cached images with the peer NCs, if any were configured
+    char *image_peers = getConfString(nc_state.configFiles, 2, CONFIG_IMAGE_PEERS);
+    if (image_peers && (image_peers[0] != '\0')) {
+        char *nc_port = getConfString(nc_state.configFiles, 2, CONFIG_NC_PORT);
+        char peer_path[EUCA_MAX_PATH] = "";
+        snprintf(peer_path, sizeof(peer_path), "%s/peer", instances_path);
+        if (vbr_set_image_peers(image_peers, ((nc_port) ? atoi(nc_port) : 8775), peer_path) != EUCA_OK)
+            LOGWARN("failed to set up the sharing of cached images with peers\n");
+        EUCA_FREE(nc_port);
+    }
+    EUCA_FREE(image_peers);
+    // record the work-space limit for max_disk
+    long long work_size_gb = (long long)(work_size_mb / MB_PER_DISK_UNIT);
+    if (conf_work_overhead_mb < 0 || conf_work_overhead_mb > work_size_mb) {    // sanity check work overhead
+        conf_work_overhead_mb = PER_INSTANCE_BUFFER_MB;
     }
-    goto free;
 
-shutoff:                              // escape point for error conditions
-    change_state(instance, SHUTOFF);
+    long long overhead_mb = work_size_gb * conf_work_overhead_mb;   // work_size_gb is the theoretical max number of instances
+    long long disk_max_mb = work_size_mb - overhead_mb;
+    nc_state.disk_max = disk_max_mb / MB_PER_DISK_UNIT;
+
+    LOGINFO("disk space for instances: %s/work\n", instances_path);
+    LOGINFO("                          %06lldMB limit (%.1f%% of the file system) - %lldMB overhead = %lldMB = %lldGB\n",
+            work_size_mb, ((double)work_size_mb / (double)work_fs_size_mb) * 100.0, overhead_mb, disk_max_mb, nc_state.disk_max);
+    LOGINFO("                          %06lldMB reserved for use (%.1f%% of limit)\n", work_bs_reserved_mb, ((double)work_bs_reserved_mb / (double)work_size_mb) * 100.0);
+    LOGINFO("                          %06lldMB allocated for use (%.1f%% of limit, %.1f%% of the file system)\n", work_bs_allocated_mb,
+            ((double)work_bs_allocated_mb / (double)work_size_mb) * 100.0, ((double)work_bs_allocated_mb / (double)work_fs_size_mb) * 100.0);
+
+    if (cache_size_mb) {
+        LOGINFO("    disk space for cache: %s/cache\n", instances_path);
+        LOGINFO("                          %06lldMB limit (%.1f%% of the file system)\n", cache_size_mb, ((double)cache_size_mb / (double)cache_fs_size_mb) * 100.0);
+        LOGINFO("                          %06lldMB reserved for use (%.1f%% of limit)\n", cache_bs_reserved_mb,
+                ((double)cache_bs_reserved_mb / (double)cache_size_mb) * 100.0);
+        LOGINFO("                          %06lldMB allocated for use (%.1f%% of limit, %.1f%% of the file system)\n", cache_bs_allocated_mb,
+                ((double)cache_bs_allocated_mb / (double)cache_size_mb) * 100.0, ((double)cache_bs_allocated_mb / (double)cache_fs_size_mb) * 100.0);
+    } else {
+        LOGWARN("disk cache will not be used\n");
+    }
 
-free:
-    EUCA_FREE(xml);
-    EUCA_FREE(brname);
-    unset_corrid(get_corrid());
-    return NULL;
+    EUCA_FREE(instances_path);
+    return (EUCA_OK);
 }
 
 //!
-//! Defines the termination thread.
-//!
-//! @param[in] arg a transparent pointer to the argument passed to this thread handler
+//! Initialization step that adopts the instances found running on the hypervisor
 //!
-//! @return Always return NULL
+//! @return Always return EUCA_OK
 //!
-void *terminating_thread(void *arg)
+static int adopt_instances_phase(void)
 {
-    char *instanceId = (char *)arg;
-
-    LOGDEBUG("[%s] spawning terminating thread\n", instanceId);
-
-    int err = find_and_terminate_instance(instanceId);
-    if (err != EUCA_OK) {
-        goto free;
-    }
+    adopt_instances();
+    return (EUCA_OK);
+}
 
-    {
-        sem_p(inst_sem);
-        ncInstance *instance = find_instance(&global_instances, instanceId);
-        if (instance == NULL) {
-            sem_v(inst_sem);
-            goto free;
-        }
-        // change the state and let the monitoring_thread clean up state
-        if (instance->state != TEARDOWN && instance->state != CANCELED) {
-            // do not leave TEARDOWN (cleaned up) or CANCELED (already trying to terminate)
-            if (instance->state == STAGING) {
-                change_state(instance, CANCELED);
-            } else {
-                change_state(instance, SHUTOFF);
-            }
-        }
-        copy_instances();
-        sem_v(inst_sem);
+//!
+//! Initialization step that checks the integrity of the backing store, which may take a while
+//! on large hosts, and purges what the adopted instances do not use
+//!
+//! @return EUCA_OK on success or EUCA_FATAL_ERROR
+//!
+static int check_backing_phase(void)
+{
+    if (check_backing_store(&global_instances) != EUCA_OK) {    // integrity check, cleanup of unused instances and shrinking of cache
+        LOGFATAL("integrity check of the backing store failed");
+        return (EUCA_FATAL_ERROR);
     }
-free:
-    EUCA_FREE(arg);
-    unset_corrid(get_corrid());
-    return NULL;
+    return (EUCA_OK);
 }
 
 //!
-//! On startup, adopt instance found running on the hypervisor.
+//! Initialization step that sets up the network of the configured VNET_MODE
 //!
-void adopt_instances()
+//! @return EUCA_OK on success or EUCA_FATAL_ERROR
+//!
+static int init_network_phase(void)
 {
-    int dom_ids[MAXDOMS] = { 0 };
-    int num_doms = 0;
-    int i = 0;
-    int error = 0;
-    int err = 0;
-    virDomainInfo info = { 0 };
-    const char *dom_name = NULL;
-    ncInstance *instance = NULL;
-    virDomainPtr dom = NULL;
-    virConnectPtr conn = NULL;
-
-    conn = lock_hypervisor_conn();
-    if (conn == NULL)
-        return;
+    char *tmp = NULL;
+    char *bridge = NULL;
+    char *pubinterface = NULL;
 
-    LOGINFO("looking for existing domains\n");
-    virSetErrorFunc(NULL, libvirt_err_handler);
+    // setup the network
+    snprintf(nc_state.config_network_path, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT, nc_state.home);
 
-    num_doms = virConnectListDomains(conn, dom_ids, MAXDOMS);
-    if (num_doms == 0) {
-        LOGINFO("no currently running domains to adopt\n");
-        unlock_hypervisor_conn();
-        return;
+    tmp = getConfString(nc_state.configFiles, 2, "VNET_MODE");
+    if (!tmp) {
+        LOGWARN("VNET_MODE is not defined, defaulting to 'SYSTEM'\n");
+        tmp = strdup(NETMODE_MANAGED_NOVLAN);
+        if (!tmp) {
+            LOGFATAL("Out of memory\n");
+            return (EUCA_FATAL_ERROR);
+        }
     }
-    if (num_doms < 0) {
-        LOGWARN("failed to find out about running domains\n");
-        unlock_hypervisor_conn();
-        return;
+
+    int initFail = 0;
+
+    if (tmp && !(!strcmp(tmp, NETMODE_SYSTEM) || !strcmp(tmp, NETMODE_STATIC) || !strcmp(tmp, NETMODE_MANAGED_NOVLAN) || !strcmp(tmp, NETMODE_MANAGED) || !strcmp(tmp, NETMODE_EDGE)
+                 || !strcmp(tmp, NETMODE_VPCMIDO))) {
+        char errorm[256];
+        memset(errorm, 0, 256);
+        sprintf(errorm, "Invalid VNET_MODE setting: %s", tmp);
+        LOGFATAL("%s\n", errorm);
+        log_eucafault("1012", "component", euca_this_component_name, "cause", errorm, NULL);
+        initFail = 1;
     }
-    // WARNING: be sure to call virDomainFree when necessary so as to avoid leaking the virDomainPtr
-    for (i = 0; i < num_doms; i++) {
-        dom = virDomainLookupByID(conn, dom_ids[i]);
-        if (!dom) {
-            LOGWARN("failed to lookup running domain #%d, ignoring it\n", dom_ids[i]);
-            continue;
-        }
-        error = virDomainGetInfo(dom, &info);
-        if ((error < 0) || (info.state == VIR_DOMAIN_NOSTATE)) {
-            LOGWARN("failed to get info on running domain #%d, ignoring it\n", dom_ids[i]);
-            virDomainFree(dom);
-            continue;
+
+    if (tmp
+        && (!strcmp(tmp, NETMODE_SYSTEM) || !strcmp(tmp, NETMODE_STATIC) || !strcmp(tmp, NETMODE_MANAGED_NOVLAN) || !strcmp(tmp, NETMODE_EDGE) || !strcmp(tmp, NETMODE_VPCMIDO))) {
+        bridge = getConfString(nc_state.configFiles, 2, "VNET_BRIDGE");
+        if (!bridge) {
+            LOGFATAL("in 'SYSTEM', 'STATIC', 'EDGE', or 'MANAGED-NOVLAN' network mode, you must specify a value for VNET_BRIDGE\n");
+            initFail = 1;
         }
+    }
+    if (tmp && (!strcmp(tmp, NETMODE_MANAGED) || !strcmp(tmp, NETMODE_EDGE))) {
+        pubinterface = getConfString(nc_state.configFiles, 2, "VNET_PUBINTERFACE");
+        if (!pubinterface)
+            pubinterface = getConfString(nc_state.configFiles, 2, "VNET_INTERFACE");
 
-        if (info.state == VIR_DOMAIN_SHUTDOWN || info.state == VIR_DOMAIN_SHUTOFF || info.state == VIR_DOMAIN_CRASHED) {
-            LOGDEBUG("ignoring non-running domain #%d\n", dom_ids[i]);
-            virDomainFree(dom);
-            continue;
+        if (!pubinterface) {
+            LOGWARN("VNET_PUBINTERFACE is not defined, defaulting to 'eth0'\n");
+            pubinterface = strdup("eth0");
+            if (!pubinterface) {
+                LOGFATAL("out of memory!\n");
+                initFail = 1;
+            }
         }
+    }
 
-        if ((dom_name = virDomainGetName(dom)) == NULL) {
-            LOGWARN("failed to get name of running domain #%d, ignoring it\n", dom_ids[i]);
-            virDomainFree(dom);
-            continue;
+    if (!initFail) {
+        initFail = vnetInit(nc_state.vnetconfig,
+                            tmp, nc_state.home, nc_state.config_network_path, NC, pubinterface, pubinterface, NULL, NULL, NULL, NULL, NULL, NULL,
+                            NULL, NULL, NULL, bridge, NULL, NULL);
+    }
+
+    EUCA_FREE(pubinterface);
+    EUCA_FREE(bridge);
+    EUCA_FREE(tmp);
+
+    if (initFail)
+        return (EUCA_FATAL_ERROR);
+
+    //
+    // Fix EUCA-9807. Only in SYSTEM mode, we unset and reset the CLC IP for
+    // metadata redirect rule to handle NC reboot case
+    //
+    if (!strcmp(nc_state.vnetconfig->mode, NETMODE_SYSTEM)) {
+        if (nc_state.vnetconfig->cloudIp != 0) {
+            if (vnetUnsetMetadataRedirect(nc_state.vnetconfig) != EUCA_OK) {
+                LOGDEBUG("Failed to unset metadata redirect on NC startup. Ignore if this wan't set previously.");
+            }
+            vnetSetMetadataRedirect(nc_state.vnetconfig);
         }
-        if (!strcmp(dom_name, "Domain-0")) {
-            virDomainFree(dom);
-            continue;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Initialization step that finds the iSCSI initiator name and the IP of this node, which
+//! volume attachments are set up with
+//!
+//! @return EUCA_OK on success or EUCA_FATAL_ERROR
+//!
+static int init_identity_phase(void)
+{
+    char *tmp = NULL;
+
+    {
+        // set enable ws-security
+        tmp = getConfString(nc_state.configFiles, 2, CONFIG_ENABLE_WS_SECURITY);
+        if (tmp && !strcmp(tmp, "N")) {
+            LOGDEBUG("Configuring no use of WS-SEC as specified in config file by explicit 'no' value\n");
+            nc_state.config_use_ws_sec = 0;
+            EUCA_FREE(tmp);
+        } else {
+            LOGDEBUG("Configured to use WS-SEC by default\n");
+            if (tmp)
+                EUCA_FREE(tmp);
+            nc_state.config_use_ws_sec = 1;
         }
+    }
 
-        if ((instance = load_instance_struct(dom_name)) == NULL) {
-            LOGWARN("failed to recover Eucalyptus metadata of running domain %s, ignoring it\n", dom_name);
-            virDomainFree(dom);
-            continue;
+    {                                  // find and set iqn
+        snprintf(nc_state.iqn, CHAR_BUFFER_SIZE, "UNSET");
+        char *ptr = NULL, *iqn = NULL, *tmp = NULL, cmd[EUCA_MAX_PATH];
+        snprintf(cmd, EUCA_MAX_PATH, "%s cat /etc/iscsi/initiatorname.iscsi", nc_state.rootwrap_cmd_path);
+        ptr = system_output(cmd);
+        if (ptr) {
+            iqn = strstr(ptr, "InitiatorName=");
+            if (iqn) {
+                iqn += strlen("InitiatorName=");
+                tmp = strstr(iqn, "\n");
+                if (tmp)
+                    *tmp = '\0';
+                snprintf(nc_state.iqn, CHAR_BUFFER_SIZE, "%s", iqn);
+            }
+            EUCA_FREE(ptr);
         }
+    }
 
-        virDomainFree(dom);
-
-        if (call_hooks(NC_EVENT_ADOPTING, instance->instancePath)) {
-            LOGINFO("[%s] ignoring running domain due to hooks\n", instance->instanceId);
-            free_instance(&instance);
-            continue;
+    {                                  // find and set IP
+        char hostname[HOSTNAME_SIZE];
+        if (gethostname(hostname, sizeof(hostname)) != 0) {
+            LOGFATAL("failed to find hostname\n");
+            return (EUCA_FATAL_ERROR);
         }
 
-        change_state(instance, info.state);
-        sem_p(inst_sem);
-        {
-            err = add_instance(&global_instances, instance);
+        struct hostent *he;
+        if ((he = gethostbyname(hostname)) == NULL) {
+            LOGFATAL("failed to obtain host information for %s\n", hostname);
+            return (EUCA_FATAL_ERROR);
         }
-        sem_v(inst_sem);
 
-        if (err) {
-            free_instance(&instance);
-            continue;
+        int found = 0;
+        struct in_addr **addr_list = (struct in_addr **)he->h_addr_list;
+        for (int i = 0; !found && addr_list[i] != NULL; i++) {
+            if (!found) {
+                euca_strncpy(nc_state.ip, inet_ntoa(*addr_list[i]), sizeof(nc_state.ip));
+                found = 1;
+            }
         }
+        if (!found) {
+            LOGFATAL("failed to obtain IP for %s\n", hostname);
+            return (EUCA_FATAL_ERROR);
+        }
+        LOGINFO("using IP %s\n", nc_state.ip);
 
-        sensor_add_resource(instance->instanceId, "instance", instance->uuid);  // ensure the sensor system monitors this instance
-        sensor_set_resource_alias(instance->instanceId, instance->ncnet.privateIp);
-        update_disk_aliases(instance);
-
-        //! @TODO try to re-check IPs?
-        LOGINFO("[%s] - adopted running domain from user %s\n", instance->instanceId, instance->userId);
-    }
-    unlock_hypervisor_conn();
-
-    sem_p(inst_sem);
-    {
-        copy_instances();              // copy global_instances to global_instances_copy
+        LOGINFO("Initializing localhost info for vbr processing\n");
+        if (vbr_init_hostconfig(nc_state.iqn, nc_state.ip, nc_state.config_sc_policy_file, nc_state.config_use_ws_sec, nc_state.config_use_virtio_root, nc_state.config_use_virtio_disk) != 0) {
+            LOGFATAL("Error initializing vbr localhost configuration\n");
+            return (EUCA_FATAL_ERROR);
+        }
     }
-    sem_v(inst_sem);
-}
-
-//!
-//!
-//!
-//! @param[in] sig
-//!
-static void nc_signal_handler(int sig)
-{
-    LOGDEBUG("signal handler caught %d\n", sig);
+    return (EUCA_OK);
 }
 
 //!
@@ -2135,25 +5609,13 @@ static void nc_signal_handler(int sig)
 //!
 static int init(void)
 {
-#define GET_VAR_INT(_var, _name, _def)                   \
-{                                                        \
-	s = getConfString(nc_state.configFiles, 2, (_name)); \
-	if (s) {					                         \
-		(_var) = atoi(s);                                \
-		EUCA_FREE(s);                                    \
-	} else {                                             \
-		(_var) = (_def);                                 \
-	}                                                    \
-}
-
     static int initialized = 0;
     int do_warn = 0, i;
     char logFile[EUCA_MAX_PATH] = "";
     char logFileReqTrack[EUCA_MAX_PATH] = "";
-    char *bridge = NULL;
     char *s = NULL;
     char *tmp = NULL;
-    char *pubinterface = NULL;
+    long long started = mono_time_usec();
     struct stat mystat = { 0 };
     struct handlers **h = NULL;
     sigset_t mask = { {0} };
@@ -2264,6 +5726,20 @@ static int init(void)
             GET_VAR_INT(nc_state.config_use_virtio_net, CONFIG_USE_VIRTIO_NET, 0);  // for now, these three Virtio settings must be set before anything in xml.c is invoked
             GET_VAR_INT(nc_state.config_use_virtio_disk, CONFIG_USE_VIRTIO_DISK, 0);
             GET_VAR_INT(nc_state.config_use_virtio_root, CONFIG_USE_VIRTIO_ROOT, 0);
+            GET_VAR_INT(nc_state.config_virtio_net_queues, CONFIG_VIRTIO_NET_QUEUES, 0);
+            GET_VAR_INT(nc_state.config_virtio_net_ring_size, CONFIG_VIRTIO_NET_RING_SIZE, 0);
+            GET_VAR_INT(nc_state.config_virtio_iothreads, CONFIG_VIRTIO_IOTHREADS, 0);
+            GET_VAR_INT(nc_state.memory_density, CONFIG_MEMORY_DENSITY, 0);
+            nc_state.config_balloon_stats_period = (nc_state.memory_density ? DENSITY_BALLOON_STATS_PERIOD : 0);
+            if ((s = getConfString(nc_state.configFiles, 2, CONFIG_VIRTIO_TUNED_VM_TYPES)) != NULL) {
+                euca_strncpy(nc_state.config_virtio_tuned_vm_types, s, sizeof(nc_state.config_virtio_tuned_vm_types));
+                EUCA_FREE(s);
+            }
+            GET_VAR_INT(nc_state.lazy_boot, CONFIG_LAZY_BOOT, 0);
+            GET_VAR_INT(nc_state.lazy_pull_bandwidth_mbs, CONFIG_LAZY_PULL_BANDWIDTH, 0);
+            vbr_set_lazy_boot(nc_state.lazy_boot ? TRUE : FALSE);
+            GET_VAR_INT(nc_state.compress_cached_images, CONFIG_COMPRESS_CACHED_IMAGES, 0);
+            vbr_set_compressed_cache(nc_state.compress_cached_images ? TRUE : FALSE);
         }
         EUCA_FREE(hypervisor);
     }
@@ -2376,8 +5852,40 @@ static int init(void)
     GET_VAR_INT(nc_state.save_instance_files, CONFIG_SAVE_INSTANCES, 0);
     GET_VAR_INT(nc_state.concurrent_disk_ops, CONFIG_CONCURRENT_DISK_OPS, 4);
     GET_VAR_INT(nc_state.sc_request_timeout_sec, CONFIG_SC_REQUEST_TIMEOUT, 45);
+    GET_VAR_INT(nc_state.use_sc_pool, CONFIG_SC_CONNECTION_POOL, 1);
+    GET_VAR_INT(nc_state.createimage_live, CONFIG_CREATEIMAGE_LIVE, 0);
     GET_VAR_INT(nc_state.concurrent_cleanup_ops, CONFIG_CONCURRENT_CLEANUP_OPS, 30);
+    GET_VAR_INT(nc_state.concurrent_launch_fetch, CONFIG_CONCURRENT_LAUNCH_FETCH, 8);
+    GET_VAR_INT(nc_state.concurrent_launch_prepare, CONFIG_CONCURRENT_LAUNCH_PREPARE, 8);
+    GET_VAR_INT(nc_state.concurrent_launch_define, CONFIG_CONCURRENT_LAUNCH_DEFINE, 1);
+    GET_VAR_INT(nc_state.concurrent_launch_boot, CONFIG_CONCURRENT_LAUNCH_BOOT, 4);
+    pthread_mutex_lock(&launch_stages_mutex);
+    launch_stages[LAUNCH_FETCH].limit = ((nc_state.concurrent_launch_fetch > 0) ? nc_state.concurrent_launch_fetch : 0);
+    launch_stages[LAUNCH_PREPARE].limit = ((nc_state.concurrent_launch_prepare > 0) ? nc_state.concurrent_launch_prepare : 0);
+    launch_stages[LAUNCH_DEFINE].limit = ((nc_state.concurrent_launch_define > 0) ? nc_state.concurrent_launch_define : 0);
+    launch_stages[LAUNCH_BOOT].limit = ((nc_state.concurrent_launch_boot > 0) ? nc_state.concurrent_launch_boot : 0);
+    pthread_mutex_unlock(&launch_stages_mutex);
     GET_VAR_INT(nc_state.disable_snapshots, CONFIG_DISABLE_SNAPSHOTS, 0);
+    GET_VAR_INT(nc_state.thin_snapshots, CONFIG_THIN_SNAPSHOTS, 0);
+    GET_VAR_INT(nc_state.reclaim_sparse_blocks, CONFIG_RECLAIM_SPARSE_BLOCKS, 0);
+    euca_strncpy(nc_state.cache_io_policy, "sequential,dontneed", sizeof(nc_state.cache_io_policy));
+    if ((s = getConfString(nc_state.configFiles, 2, CONFIG_CACHE_IO_POLICY)) != NULL) {
+        euca_strncpy(nc_state.cache_io_policy, s, sizeof(nc_state.cache_io_policy));
+        EUCA_FREE(s);
+    }
+    euca_strncpy(nc_state.work_io_policy, "sequential,direct", sizeof(nc_state.work_io_policy));
+    if ((s = getConfString(nc_state.configFiles, 2, CONFIG_WORK_IO_POLICY)) != NULL) {
+        euca_strncpy(nc_state.work_io_policy, s, sizeof(nc_state.work_io_policy));
+        EUCA_FREE(s);
+    }
+    GET_VAR_INT(nc_state.prestage_bandwidth_mbs, CONFIG_PRESTAGE_BANDWIDTH, 0);
+    nc_state.fast_cache_path[0] = '\0';
+    if ((s = getConfString(nc_state.configFiles, 2, CONFIG_NC_FAST_CACHE_PATH)) != NULL) {
+        euca_strncpy(nc_state.fast_cache_path, s, sizeof(nc_state.fast_cache_path));
+        EUCA_FREE(s);
+    }
+    GET_VAR_INT(nc_state.fast_cache_size_mb, CONFIG_NC_FAST_CACHE_SIZE, 0);
+    GET_VAR_INT(nc_state.stream_image_downloads, CONFIG_STREAM_IMAGE_DOWNLOADS, 0);
     GET_VAR_INT(nc_state.shutdown_grace_period_sec, CONFIG_SHUTDOWN_GRACE_PERIOD_SEC, 60);
 
     strcpy(nc_state.admin_user_id, EUCALYPTUS_ADMIN);
@@ -2385,396 +5893,144 @@ static int init(void)
     GET_VAR_INT(nc_state.booting_cleanup_threshold, CONFIG_NC_BOOTING_CLEANUP_THRESHOLD, default_booting_cleanup_threshold);
     GET_VAR_INT(nc_state.bundling_cleanup_threshold, CONFIG_NC_BUNDLING_CLEANUP_THRESHOLD, default_bundling_cleanup_threshold);
     GET_VAR_INT(nc_state.createImage_cleanup_threshold, CONFIG_NC_CREATEIMAGE_CLEANUP_THRESHOLD, default_createImage_cleanup_threshold);
-    GET_VAR_INT(nc_state.teardown_state_duration, CONFIG_NC_TEARDOWN_STATE_DURATION, default_teardown_state_duration);
-    GET_VAR_INT(nc_state.migration_ready_threshold, CONFIG_NC_MIGRATION_READY_THRESHOLD, default_migration_ready_threshold);
-    int max_attempts;
-    GET_VAR_INT(max_attempts, CONFIG_WALRUS_DOWNLOAD_MAX_ATTEMPTS, -1);
-    if (max_attempts > 0 && max_attempts < 99)
-        objectstorage_set_max_download_attempts(max_attempts);
-
-    // add three eucalyptus directories with executables to PATH of this process
-    add_euca_to_path(nc_state.home);
-
-    // read in .pem files
-    if (euca_init_cert()) {
-        LOGWARN("no cryptographic certificates found: waiting for node to be registered...\n");
-        //        return (EUCA_FATAL_ERROR);
-    }
-    // check on dependencies (3rd-party programs that NC invokes)
-    if (diskutil_init(FALSE)) {        // NC does not need GRUB for now
-        LOGFATAL("failed to find required dependencies for disk operations\n");
-        return (EUCA_FATAL_ERROR);
-    }
-    // check on the Imaging Toolkit readyness
-    char node_pk_path[EUCA_MAX_PATH];
-    snprintf(node_pk_path, sizeof(node_pk_path), EUCALYPTUS_KEYS_DIR "/node-pk.pem", nc_state.home);
-    char cloud_cert_path[EUCA_MAX_PATH];
-    snprintf(cloud_cert_path, sizeof(cloud_cert_path), EUCALYPTUS_KEYS_DIR "/cloud-cert.pem", nc_state.home);
-    if (imaging_init(nc_state.home, cloud_cert_path, node_pk_path)) {
-        LOGFATAL("failed to find required dependencies for image work\n");
-        return (EUCA_FATAL_ERROR);
-    }
-
-    if (sensor_init(NULL, NULL, MAX_SENSOR_RESOURCES, FALSE, NULL) != EUCA_OK) {
-        LOGERROR("failed to initialize sensor subsystem in this process\n");
-        return (EUCA_FATAL_ERROR);
-    }
-    //// from now on we have unrecoverable failure, so no point in retrying to re-init ////
-    initialized = -1;
-
-    hyp_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    inst_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    inst_copy_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    addkey_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    log_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    service_state_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    stats_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-
-    if (!hyp_sem || !inst_sem || !inst_copy_sem || !addkey_sem || !log_sem || !service_state_sem) {
-        LOGFATAL("failed to create and initialize semaphores\n");
-        return (EUCA_FATAL_ERROR);
-    }
-    if (log_sem_set(log_sem) != 0) {
-        LOGFATAL("failed to set logging semaphore\n");
-        return (EUCA_FATAL_ERROR);
-    }
-    if (sensor_set_hyp_sem(hyp_sem) != 0) {
-        LOGFATAL("failed to set hypervisor semaphore for the sensor subsystem\n");
-        return (EUCA_FATAL_ERROR);
-    }
-    if ((loop_sem = diskutil_get_loop_sem()) == NULL) { // NC does not need GRUB for now
-        LOGFATAL("failed to find all dependencies\n");
-        return (EUCA_FATAL_ERROR);
-    }
-
-    if (init_eucafaults(euca_this_component_name) == 0) {
-        LOGFATAL("failed to initialize fault-logging subsystem\n");
-        return (EUCA_FATAL_ERROR);
-    }
-
-    if (init_ebs_utils(nc_state.sc_request_timeout_sec) != 0) {
-        LOGFATAL("Failed to initialize ebs utils\n");
-        return (EUCA_FATAL_ERROR);
-    }
-
-    // initialize the EBS subsystem
-    update_ebs_params();
-
-    // NOTE: this is the only call which needs to be called on both
-    // the default and the specific handler! All the others will be
-    // either or
-    i = nc_state.D->doInitialize(&nc_state);
-    if (nc_state.H->doInitialize)
-        i += nc_state.H->doInitialize(&nc_state);
-
-    if (i) {
-        LOGFATAL("failed to initialized hypervisor driver!\n");
-        return (EUCA_FATAL_ERROR);
-    }
-
-    {
-        // check on hypervisor and pull out capabilities
-        virConnectPtr conn = lock_hypervisor_conn();
-        if (conn == NULL) {
-            LOGFATAL("unable to contact hypervisor\n");
-            return (EUCA_FATAL_ERROR);
-        }
-        char *caps_xml = virConnectGetCapabilities(conn);
-        if (caps_xml == NULL) {
-            LOGFATAL("unable to obtain hypervisor capabilities\n");
-            unlock_hypervisor_conn();
-            return (EUCA_FATAL_ERROR);
-        }
-        unlock_hypervisor_conn();
-        if (strstr(caps_xml, "<live/>") != NULL) {
-            nc_state.migration_capable = 1;
-        }
-        EUCA_FREE(caps_xml);
-    }
-    LOGINFO("hypervisor %scapable of live migration\n", nc_state.migration_capable ? "" : "not ");
-
-    // now that hypervisor-specific initializers have discovered mem_max and cores_max,
-    // adjust the values based on configuration parameters, if any
-    if (nc_state.config_max_mem) {
-        if (nc_state.config_max_mem > nc_state.mem_max)
-            LOGWARN("MAX_MEM value is set to %lldMB that is greater than the amount of physical memory: %lldMB\n", nc_state.config_max_mem, nc_state.mem_max);
-        nc_state.mem_max = nc_state.config_max_mem;
-    } else {
-        nc_state.mem_max = nc_state.phy_max_mem;
-    }
-
-    if (nc_state.config_max_cores) {
-        int cores = nc_state.cores_max;
-        nc_state.cores_max = nc_state.config_max_cores;
-        if (nc_state.cores_max > MAXINSTANCES_PER_NC) {
-            nc_state.cores_max = MAXINSTANCES_PER_NC;
-            LOGWARN("ignoring excessive MAX_CORES value (leaving at %lld)\n", nc_state.cores_max);
-        }
-
-        if (nc_state.cores_max > cores)
-            LOGWARN("MAX_CORES value is set to %lld that is greater than the amount of physical cores: %d\n", nc_state.cores_max, cores);
-    } else {
-        nc_state.cores_max = nc_state.phy_max_cores;
-    }
-
-    LOGINFO("physical memory available for instances: %lldMB\n", nc_state.mem_max);
-    LOGINFO("virtual cpu cores available for instances: %lld\n", nc_state.cores_max);
-
-    {
-        // backing store configuration
-        char *instances_path = getConfString(nc_state.configFiles, 2, INSTANCE_PATH);
-
-        if (instances_path == NULL) {
-            LOGERROR("%s is not set\n", INSTANCE_PATH);
-            return (EUCA_FATAL_ERROR);
-        }
-        // create work and cache sub-directories so that stat_backing_store() below succeeds
-        char cache_path[EUCA_MAX_PATH];
-        snprintf(cache_path, sizeof(cache_path), "%s/cache", instances_path);
-        if (ensure_directories_exist(cache_path, 0, NULL, NULL, BACKING_DIRECTORY_PERM) == -1) {
-            EUCA_FREE(instances_path);
-            return (EUCA_ERROR);
-        }
-
-        char work_path[EUCA_MAX_PATH];
-        snprintf(work_path, sizeof(work_path), "%s/work", instances_path);
-        if (ensure_directories_exist(work_path, 0, NULL, NULL, BACKING_DIRECTORY_PERM) == -1) {
-            EUCA_FREE(instances_path);
-            return (EUCA_ERROR);
-        }
-        // determine how much is used/available in work and cache areas on the backing store
-        blobstore_meta work_meta, cache_meta;
-        stat_backing_store(instances_path, &work_meta, &cache_meta);    // will zero-out work_ and cache_meta
-        long long work_fs_size_mb = (long long)(work_meta.fs_bytes_size / MEGABYTE);
-        long long work_fs_avail_mb = (long long)(work_meta.fs_bytes_available / MEGABYTE);
-        long long cache_fs_size_mb = (long long)(cache_meta.fs_bytes_size / MEGABYTE);
-        long long cache_fs_avail_mb = (long long)(cache_meta.fs_bytes_available / MEGABYTE);
-        long long work_bs_size_mb = work_meta.blocks_limit ? (work_meta.blocks_limit / SEC_PER_MB) : (-1L); // convert sectors->MB
-        long long work_bs_allocated_mb = work_meta.blocks_limit ? (work_meta.blocks_allocated / SEC_PER_MB) : 0;
-        long long work_bs_reserved_mb = work_meta.blocks_limit ? ((work_meta.blocks_locked + work_meta.blocks_unlocked) / SEC_PER_MB) : 0;
-        long long cache_bs_size_mb = cache_meta.blocks_limit ? (cache_meta.blocks_limit / SEC_PER_MB) : (-1L);
-        long long cache_bs_allocated_mb = cache_meta.blocks_limit ? (cache_meta.blocks_allocated / SEC_PER_MB) : 0;
-        long long cache_bs_reserved_mb = cache_meta.blocks_limit ? ((cache_meta.blocks_locked + cache_meta.blocks_unlocked) / SEC_PER_MB) : 0;
-
-        // sanity check
-        if (work_fs_avail_mb < MIN_BLOBSTORE_SIZE_MB) {
-            LOGERROR("insufficient available work space (%lld MB) under %s/work\n", work_fs_avail_mb, instances_path);
-            EUCA_FREE(instances_path);
-            return (EUCA_FATAL_ERROR);
-        }
-        // look up configuration file settings for work and cache size
-        long long conf_work_size_mb;
-        GET_VAR_INT(conf_work_size_mb, CONFIG_NC_WORK_SIZE, -1);
-
-        long long conf_cache_size_mb;
-        GET_VAR_INT(conf_cache_size_mb, CONFIG_NC_CACHE_SIZE, -1);
-
-        long long conf_work_overhead_mb;
-        GET_VAR_INT(conf_work_overhead_mb, CONFIG_NC_OVERHEAD_SIZE, PER_INSTANCE_BUFFER_MB);
-
-        {                              // accommodate legacy MAX_DISK setting by converting it
-            int max_disk_gb;
-            GET_VAR_INT(max_disk_gb, CONFIG_MAX_DISK, -1);
-            if (max_disk_gb != -1) {
-                if (conf_work_size_mb == -1) {
-                    LOGWARN("using deprecated setting %s for the new setting %s\n", CONFIG_MAX_DISK, CONFIG_NC_WORK_SIZE);
-                    if (max_disk_gb == 0) {
-                        conf_work_size_mb = -1; // change in semantics: 0 used to mean 'unlimited', now 'unset' or -1 means that
-                    } else {
-                        conf_work_size_mb = max_disk_gb * 1024;
-                    }
-                } else {
-                    LOGWARN("ignoring deprecated setting %s in favor of the new setting %s\n", CONFIG_MAX_DISK, CONFIG_NC_WORK_SIZE);
-                }
-            }
-        }
-
-        // decide what work and cache sizes should be, based on all the inputs
-        long long work_size_mb = -1;
-        long long cache_size_mb = -1;
-
-        // above all, try to respect user-specified limits for work and cache
-        if (conf_work_size_mb != -1) {
-            if (conf_work_size_mb < MIN_BLOBSTORE_SIZE_MB) {
-                LOGWARN("ignoring specified work size (%s=%lld) that is below acceptable minimum (%d)\n", CONFIG_NC_WORK_SIZE, conf_work_size_mb, MIN_BLOBSTORE_SIZE_MB);
-            } else {
-                if (work_bs_size_mb != -1 && work_bs_size_mb != conf_work_size_mb) {
-                    LOGWARN("specified work size (%s=%lld) differs from existing work size (%lld), will try resizing\n", CONFIG_NC_WORK_SIZE, conf_work_size_mb, work_bs_size_mb);
-                }
-                work_size_mb = conf_work_size_mb;
-            }
-        }
-
-        if (conf_cache_size_mb != -1) { // respect user-specified limit
-            if (conf_cache_size_mb < MIN_BLOBSTORE_SIZE_MB) {
-                cache_size_mb = 0;     // so it won't be used
-            } else {
-                if (cache_bs_size_mb != -1 && cache_bs_size_mb != conf_cache_size_mb) {
-                    LOGWARN("specified cache size (%s=%lld) differs from existing cache size (%lld), will try resizing\n",
-                            CONFIG_NC_CACHE_SIZE, conf_cache_size_mb, cache_bs_size_mb);
-                }
-                cache_size_mb = conf_cache_size_mb;
-            }
-        }
-        // if the user did not specify sizes, try existing blobstores,
-        // if any, whose limits would have been chosen earlier
-        if (work_size_mb == -1 && work_bs_size_mb != -1)
-            work_size_mb = work_bs_size_mb;
-
-        if (cache_size_mb == -1 && cache_bs_size_mb != -1)
-            cache_size_mb = cache_bs_size_mb;
-
-        // if the user did not specify either or both of the sizes,
-        // and blobstores do not exist yet, make reasonable choices
-        if (memcmp(&work_meta.fs_id, &cache_meta.fs_id, sizeof(fsid_t)) == 0) { // cache and work are on the same file system
-            long long fs_usable_mb = (long long)((double)work_fs_avail_mb - (double)(work_fs_avail_mb) * FS_BUFFER_PERCENT);
-            if (work_size_mb == -1 && cache_size_mb == -1) {
-                work_size_mb = (long long)((double)fs_usable_mb * WORK_BS_PERCENT);
-                cache_size_mb = fs_usable_mb - work_size_mb;
-            } else if (work_size_mb == -1) {
-                work_size_mb = fs_usable_mb - cache_size_mb + cache_bs_allocated_mb;
-            } else if (cache_size_mb == -1) {
-                cache_size_mb = fs_usable_mb - work_size_mb + work_bs_allocated_mb;
-            }
-            // sanity check
-            if ((cache_size_mb + work_size_mb - cache_bs_allocated_mb - work_bs_allocated_mb) > work_fs_avail_mb) {
-                LOGWARN("sum of work and cache sizes exceeds available disk space\n");
-            }
-        } else {                       // cache and work are on different file systems
-            if (work_size_mb == -1) {
-                work_size_mb = (long long)((double)work_fs_avail_mb - (double)(work_fs_avail_mb) * FS_BUFFER_PERCENT);
-            }
-
-            if (cache_size_mb == -1) {
-                cache_size_mb = (long long)((double)cache_fs_avail_mb - (double)(cache_fs_avail_mb) * FS_BUFFER_PERCENT);
-            }
-        }
-
-        // sanity-check final results
-        if (cache_size_mb < MIN_BLOBSTORE_SIZE_MB)
-            cache_size_mb = 0;
-
-        if (work_size_mb < MIN_BLOBSTORE_SIZE_MB) {
-            LOGERROR("insufficient disk space for virtual machines\n");
-            EUCA_FREE(instances_path);
-            return (EUCA_FATAL_ERROR);
-        }
-
-        if (init_backing_store(instances_path, work_size_mb, cache_size_mb)) {
-            LOGFATAL("failed to initialize backing store\n");
-            EUCA_FREE(instances_path);
-            return (EUCA_FATAL_ERROR);
-        }
-        // record the work-space limit for max_disk
-        long long work_size_gb = (long long)(work_size_mb / MB_PER_DISK_UNIT);
-        if (conf_work_overhead_mb < 0 || conf_work_overhead_mb > work_size_mb) {    // sanity check work overhead
-            conf_work_overhead_mb = PER_INSTANCE_BUFFER_MB;
-        }
-
-        long long overhead_mb = work_size_gb * conf_work_overhead_mb;   // work_size_gb is the theoretical max number of instances
-        long long disk_max_mb = work_size_mb - overhead_mb;
-        nc_state.disk_max = disk_max_mb / MB_PER_DISK_UNIT;
-
-        LOGINFO("disk space for instances: %s/work\n", instances_path);
-        LOGINFO("                          %06lldMB limit (%.1f%% of the file system) - %lldMB overhead = %lldMB = %lldGB\n",
-                work_size_mb, ((double)work_size_mb / (double)work_fs_size_mb) * 100.0, overhead_mb, disk_max_mb, nc_state.disk_max);
-        LOGINFO("                          %06lldMB reserved for use (%.1f%% of limit)\n", work_bs_reserved_mb, ((double)work_bs_reserved_mb / (double)work_size_mb) * 100.0);
-        LOGINFO("                          %06lldMB allocated for use (%.1f%% of limit, %.1f%% of the file system)\n", work_bs_allocated_mb,
-                ((double)work_bs_allocated_mb / (double)work_size_mb) * 100.0, ((double)work_bs_allocated_mb / (double)work_fs_size_mb) * 100.0);
-
-        if (cache_size_mb) {
-            LOGINFO("    disk space for cache: %s/cache\n", instances_path);
-            LOGINFO("                          %06lldMB limit (%.1f%% of the file system)\n", cache_size_mb, ((double)cache_size_mb / (double)cache_fs_size_mb) * 100.0);
-            LOGINFO("                          %06lldMB reserved for use (%.1f%% of limit)\n", cache_bs_reserved_mb,
-                    ((double)cache_bs_reserved_mb / (double)cache_size_mb) * 100.0);
-            LOGINFO("                          %06lldMB allocated for use (%.1f%% of limit, %.1f%% of the file system)\n", cache_bs_allocated_mb,
-                    ((double)cache_bs_allocated_mb / (double)cache_size_mb) * 100.0, ((double)cache_bs_allocated_mb / (double)cache_fs_size_mb) * 100.0);
-        } else {
-            LOGWARN("disk cache will not be used\n");
-        }
-
-        EUCA_FREE(instances_path);
+    GET_VAR_INT(nc_state.teardown_state_duration, CONFIG_NC_TEARDOWN_STATE_DURATION, default_teardown_state_duration);
+    GET_VAR_INT(nc_state.migration_ready_threshold, CONFIG_NC_MIGRATION_READY_THRESHOLD, default_migration_ready_threshold);
+    GET_VAR_INT(nc_state.migration_max_outgoing, CONFIG_NC_MIGRATION_MAX_OUTGOING, 2);
+    GET_VAR_INT(nc_state.migration_bandwidth_mbs, CONFIG_NC_MIGRATION_BANDWIDTH, 0);
+    GET_VAR_INT(nc_state.migration_auto_converge, CONFIG_NC_MIGRATION_AUTO_CONVERGE, 0);
+    GET_VAR_INT(nc_state.migration_postcopy_after_sec, CONFIG_NC_MIGRATION_POSTCOPY_AFTER, 0);
+    GET_VAR_INT(nc_state.migration_keys_ttl_sec, CONFIG_NC_MIGRATION_KEYS_TTL, 600);
+    if ((s = getConfString(nc_state.configFiles, 2, CONFIG_NC_MIGRATION_COMPRESSION)) != NULL) {
+        euca_strncpy(nc_state.migration_compression, s, sizeof(nc_state.migration_compression));
+        EUCA_FREE(s);
     }
+    int max_attempts;
+    GET_VAR_INT(max_attempts, CONFIG_WALRUS_DOWNLOAD_MAX_ATTEMPTS, -1);
+    if (max_attempts > 0 && max_attempts < 99)
+        objectstorage_set_max_download_attempts(max_attempts);
+    int digest_ttl;
+    GET_VAR_INT(digest_ttl, CONFIG_DIGEST_CACHE_TTL, -1);
+    if (digest_ttl >= 0)
+        vbr_set_digest_cache_ttl(digest_ttl);
+    int download_streams;
+    GET_VAR_INT(download_streams, CONFIG_DOWNLOAD_STREAMS, -1);
+    if (download_streams > 0)
+        vbr_set_download_streams(download_streams);
 
-    // adopt running instances -- do this before disk integrity check so we know what can be purged
-    adopt_instances();
+    // add three eucalyptus directories with executables to PATH of this process
+    add_euca_to_path(nc_state.home);
 
-    if (check_backing_store(&global_instances) != EUCA_OK) {    // integrity check, cleanup of unused instances and shrinking of cache
-        LOGFATAL("integrity check of the backing store failed");
+    // read in .pem files
+    if (euca_init_cert()) {
+        LOGWARN("no cryptographic certificates found: waiting for node to be registered...\n");
+        //        return (EUCA_FATAL_ERROR);
+    }
+    // check on dependencies (3rd-party programs that NC invokes)
+    if (diskutil_init(FALSE)) {        // NC does not need GRUB for now
+        LOGFATAL("failed to find required dependencies for disk operations\n");
+        return (EUCA_FATAL_ERROR);
+    }
+    // check on the Imaging Toolkit readyness
+    char node_pk_path[EUCA_MAX_PATH];
+    snprintf(node_pk_path, sizeof(node_pk_path), EUCALYPTUS_KEYS_DIR "/node-pk.pem", nc_state.home);
+    char cloud_cert_path[EUCA_MAX_PATH];
+    snprintf(cloud_cert_path, sizeof(cloud_cert_path), EUCALYPTUS_KEYS_DIR "/cloud-cert.pem", nc_state.home);
+    if (imaging_init(nc_state.home, cloud_cert_path, node_pk_path)) {
+        LOGFATAL("failed to find required dependencies for image work\n");
         return (EUCA_FATAL_ERROR);
     }
-    // setup the network
-    snprintf(nc_state.config_network_path, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT, nc_state.home);
 
-    tmp = getConfString(nc_state.configFiles, 2, "VNET_MODE");
-    if (!tmp) {
-        LOGWARN("VNET_MODE is not defined, defaulting to 'SYSTEM'\n");
-        tmp = strdup(NETMODE_MANAGED_NOVLAN);
-        if (!tmp) {
-            LOGFATAL("Out of memory\n");
-            return (EUCA_FATAL_ERROR);
-        }
+    if (sensor_init(NULL, NULL, MAX_SENSOR_RESOURCES, FALSE, NULL) != EUCA_OK) {
+        LOGERROR("failed to initialize sensor subsystem in this process\n");
+        return (EUCA_FATAL_ERROR);
     }
+    //// from now on we have unrecoverable failure, so no point in retrying to re-init ////
+    initialized = -1;
 
-    int initFail = 0;
+    hyp_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    hyp_query_sem = sem_alloc(LIBVIRT_QUERY_CALLERS, IPC_MUTEX_SEMAPHORE);
+    inst_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    inst_copy_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    addkey_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    log_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    service_state_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    stats_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
 
-    if (tmp && !(!strcmp(tmp, NETMODE_SYSTEM) || !strcmp(tmp, NETMODE_STATIC) || !strcmp(tmp, NETMODE_MANAGED_NOVLAN) || !strcmp(tmp, NETMODE_MANAGED) || !strcmp(tmp, NETMODE_EDGE)
-                 || !strcmp(tmp, NETMODE_VPCMIDO))) {
-        char errorm[256];
-        memset(errorm, 0, 256);
-        sprintf(errorm, "Invalid VNET_MODE setting: %s", tmp);
-        LOGFATAL("%s\n", errorm);
-        log_eucafault("1012", "component", euca_this_component_name, "cause", errorm, NULL);
-        initFail = 1;
+    if (!hyp_sem || !hyp_query_sem || !inst_sem || !inst_copy_sem || !addkey_sem || !log_sem || !service_state_sem) {
+        LOGFATAL("failed to create and initialize semaphores\n");
+        return (EUCA_FATAL_ERROR);
     }
-
-    if (tmp
-        && (!strcmp(tmp, NETMODE_SYSTEM) || !strcmp(tmp, NETMODE_STATIC) || !strcmp(tmp, NETMODE_MANAGED_NOVLAN) || !strcmp(tmp, NETMODE_EDGE) || !strcmp(tmp, NETMODE_VPCMIDO))) {
-        bridge = getConfString(nc_state.configFiles, 2, "VNET_BRIDGE");
-        if (!bridge) {
-            LOGFATAL("in 'SYSTEM', 'STATIC', 'EDGE', or 'MANAGED-NOVLAN' network mode, you must specify a value for VNET_BRIDGE\n");
-            initFail = 1;
-        }
+    // the lock sensor reports on these while it is enabled
+    sem_stats_register(hyp_sem, "hyp_sem");
+    sem_stats_register(hyp_query_sem, "hyp_query_sem");
+    sem_stats_register(inst_sem, "inst_sem");
+    sem_stats_register(inst_copy_sem, "inst_copy_sem");
+    sem_stats_register(addkey_sem, "addkey_sem");
+    sem_stats_register(log_sem, "log_sem");
+    sem_stats_register(service_state_sem, "service_state_sem");
+    sem_stats_register(stats_sem, "stats_sem");
+    if (log_sem_set(log_sem) != 0) {
+        LOGFATAL("failed to set logging semaphore\n");
+        return (EUCA_FATAL_ERROR);
     }
-    if (tmp && (!strcmp(tmp, NETMODE_MANAGED) || !strcmp(tmp, NETMODE_EDGE))) {
-        pubinterface = getConfString(nc_state.configFiles, 2, "VNET_PUBINTERFACE");
-        if (!pubinterface)
-            pubinterface = getConfString(nc_state.configFiles, 2, "VNET_INTERFACE");
+    if (sensor_set_hyp_sem(hyp_sem) != 0) {
+        LOGFATAL("failed to set hypervisor semaphore for the sensor subsystem\n");
+        return (EUCA_FATAL_ERROR);
+    }
+    if (sensor_set_stats_collector(collect_instance_stats) != 0) {
+        LOGWARN("failed to set native stats collector, falling back to getstats.pl\n");
+    }
+    if ((loop_sem = diskutil_get_loop_sem()) == NULL) { // NC does not need GRUB for now
+        LOGFATAL("failed to find all dependencies\n");
+        return (EUCA_FATAL_ERROR);
+    }
+    sem_stats_register(loop_sem, "loop_sem");
 
-        if (!pubinterface) {
-            LOGWARN("VNET_PUBINTERFACE is not defined, defaulting to 'eth0'\n");
-            pubinterface = strdup("eth0");
-            if (!pubinterface) {
-                LOGFATAL("out of memory!\n");
-                initFail = 1;
-            }
-        }
+    if (init_eucafaults(euca_this_component_name) == 0) {
+        LOGFATAL("failed to initialize fault-logging subsystem\n");
+        return (EUCA_FATAL_ERROR);
     }
 
-    if (!initFail) {
-        initFail = vnetInit(nc_state.vnetconfig,
-                            tmp, nc_state.home, nc_state.config_network_path, NC, pubinterface, pubinterface, NULL, NULL, NULL, NULL, NULL, NULL,
-                            NULL, NULL, NULL, bridge, NULL, NULL);
+    if (init_ebs_utils(nc_state.sc_request_timeout_sec, nc_state.use_sc_pool) != 0) {
+        LOGFATAL("Failed to initialize ebs utils\n");
+        return (EUCA_FATAL_ERROR);
     }
 
-    EUCA_FREE(pubinterface);
-    EUCA_FREE(bridge);
-    EUCA_FREE(tmp);
+    // initialize the EBS subsystem
+    update_ebs_params();
 
-    if (initFail)
-        return (EUCA_FATAL_ERROR);
+    // disk and network caps of the instances to come
+    update_qos_params(FALSE);
 
-    //
-    // Fix EUCA-9807. Only in SYSTEM mode, we unset and reset the CLC IP for
-    // metadata redirect rule to handle NC reboot case
-    //
-    if (!strcmp(nc_state.vnetconfig->mode, NETMODE_SYSTEM)) {
-        if (nc_state.vnetconfig->cloudIp != 0) {
-            if (vnetUnsetMetadataRedirect(nc_state.vnetconfig) != EUCA_OK) {
-                LOGDEBUG("Failed to unset metadata redirect on NC startup. Ignore if this wan't set previously.");
-            }
-            vnetSetMetadataRedirect(nc_state.vnetconfig);
-        }
+    {
+        // bring up the hypervisor, the backing store and what identifies this node all at once,
+        // opening the blobstores of a large host takes a while and needs none of the others
+        initPhase phases[] = {
+            {"hypervisor", init_hypervisor_phase},
+            {"backing store", init_backing_phase},
+            {"node identity", init_identity_phase},
+        };
+        if ((i = run_init_phases("startup", phases, (sizeof(phases) / sizeof(initPhase)))) != EUCA_OK)
+            return (i);
+    }
+
+    {
+        // adopt running instances -- do this before disk integrity check so we know what can be purged
+        initPhase phases[] = {
+            {"adoption", adopt_instances_phase},
+        };
+        if ((i = run_init_phases("adoption", phases, (sizeof(phases) / sizeof(initPhase)))) != EUCA_OK)
+            return (i);
+    }
+
+    {
+        // the integrity check of the backing store and the network setup do not depend on each other
+        initPhase phases[] = {
+            {"backing store check", check_backing_phase},
+            {"network", init_network_phase},
+        };
+        if ((i = run_init_phases("recovery", phases, (sizeof(phases) / sizeof(initPhase)))) != EUCA_OK)
+            return (i);
     }
 
     // set NC helper path
@@ -2804,73 +6060,6 @@ static int init(void)
         snprintf(nc_state.ncDeleteBundleCmd, EUCA_MAX_PATH, "%s", EUCALYPTUS_NC_DELETE_BUNDLE); // default value
     }
 
-    {
-        // set enable ws-security
-        tmp = getConfString(nc_state.configFiles, 2, CONFIG_ENABLE_WS_SECURITY);
-        if (tmp && !strcmp(tmp, "N")) {
-            LOGDEBUG("Configuring no use of WS-SEC as specified in config file by explicit 'no' value\n");
-            nc_state.config_use_ws_sec = 0;
-            EUCA_FREE(tmp);
-        } else {
-            LOGDEBUG("Configured to use WS-SEC by default\n");
-            if (tmp)
-                EUCA_FREE(tmp);
-            nc_state.config_use_ws_sec = 1;
-        }
-    }
-
-    {                                  // find and set iqn
-        snprintf(nc_state.iqn, CHAR_BUFFER_SIZE, "UNSET");
-        char *ptr = NULL, *iqn = NULL, *tmp = NULL, cmd[EUCA_MAX_PATH];
-        snprintf(cmd, EUCA_MAX_PATH, "%s cat /etc/iscsi/initiatorname.iscsi", nc_state.rootwrap_cmd_path);
-        ptr = system_output(cmd);
-        if (ptr) {
-            iqn = strstr(ptr, "InitiatorName=");
-            if (iqn) {
-                iqn += strlen("InitiatorName=");
-                tmp = strstr(iqn, "\n");
-                if (tmp)
-                    *tmp = '\0';
-                snprintf(nc_state.iqn, CHAR_BUFFER_SIZE, "%s", iqn);
-            }
-            EUCA_FREE(ptr);
-        }
-    }
-
-    {                                  // find and set IP
-        char hostname[HOSTNAME_SIZE];
-        if (gethostname(hostname, sizeof(hostname)) != 0) {
-            LOGFATAL("failed to find hostname\n");
-            return (EUCA_FATAL_ERROR);
-        }
-
-        struct hostent *he;
-        if ((he = gethostbyname(hostname)) == NULL) {
-            LOGFATAL("failed to obtain host information for %s\n", hostname);
-            return (EUCA_FATAL_ERROR);
-        }
-
-        int found = 0;
-        struct in_addr **addr_list = (struct in_addr **)he->h_addr_list;
-        for (int i = 0; !found && addr_list[i] != NULL; i++) {
-            if (!found) {
-                euca_strncpy(nc_state.ip, inet_ntoa(*addr_list[i]), sizeof(nc_state.ip));
-                found = 1;
-            }
-        }
-        if (!found) {
-            LOGFATAL("failed to obtain IP for %s\n", hostname);
-            return (EUCA_FATAL_ERROR);
-        }
-        LOGINFO("using IP %s\n", nc_state.ip);
-
-        LOGINFO("Initializing localhost info for vbr processing\n");
-        if (vbr_init_hostconfig(nc_state.iqn, nc_state.ip, nc_state.config_sc_policy_file, nc_state.config_use_ws_sec, nc_state.config_use_virtio_root, nc_state.config_use_virtio_disk) != 0) {
-            LOGFATAL("Error initializing vbr localhost configuration\n");
-            return (EUCA_FATAL_ERROR);
-        }
-    }
-
     {
         LOGINFO("Initializing service state and epoch\n");
         //Initialize the service state info.
@@ -2910,6 +6099,42 @@ static int init(void)
         }
     }
 
+    if (nc_state.reclaim_sparse_blocks) {   // start the thread that punches zeroes out of cached images
+        pthread_t tcb;
+        if (pthread_create(&tcb, NULL, reclaiming_thread, &nc_state)) {
+            LOGFATAL("failed to spawn a reclaiming thread\n");
+            return (EUCA_FATAL_ERROR);
+        }
+        if (pthread_detach(tcb)) {
+            LOGFATAL("failed to detach the reclaiming thread\n");
+            return (EUCA_FATAL_ERROR);
+        }
+    }
+
+    if (nc_state.prestage_bandwidth_mbs > 0) {  // start the thread that keeps popular images in the cache
+        pthread_t tcb;
+        if (pthread_create(&tcb, NULL, prestaging_thread, &nc_state)) {
+            LOGFATAL("failed to spawn a pre-staging thread\n");
+            return (EUCA_FATAL_ERROR);
+        }
+        if (pthread_detach(tcb)) {
+            LOGFATAL("failed to detach the pre-staging thread\n");
+            return (EUCA_FATAL_ERROR);
+        }
+    }
+
+    if ((strlen(nc_state.fast_cache_path) > 0) && (nc_state.fast_cache_size_mb > 0)) {   // start the thread that moves images between the tiers of the cache
+        pthread_t tcb;
+        if (pthread_create(&tcb, NULL, tiering_thread, &nc_state)) {
+            LOGFATAL("failed to spawn a cache tiering thread\n");
+            return (EUCA_FATAL_ERROR);
+        }
+        if (pthread_detach(tcb)) {
+            LOGFATAL("failed to detach the cache tiering thread\n");
+            return (EUCA_FATAL_ERROR);
+        }
+    }
+
     {
 
         if(initialize_stats_system(DEFAULT_SENSOR_INTERVAL_SEC) != EUCA_OK) {
@@ -2939,6 +6164,7 @@ static int init(void)
     }
 
     initialized = 1;
+    LOGINFO("init: done in %lld ms\n", ((mono_time_usec() - started) / 1000));
     return (EUCA_OK);
 
 #undef GET_VAR_INT
@@ -3044,7 +6270,12 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncIn
                 peer = instance->migration_src;
                 dir = '<';
             }
-            snprintf(status_str, sizeof(status_str), "%s %c%s", migration_state_names[instance->migration_state], dir, peer);
+            if ((instance->migration_state == MIGRATION_IN_PROGRESS) && (dir == '>')) {
+                snprintf(status_str, sizeof(status_str), "%s %c%s %d%%%s", migration_state_names[instance->migration_state], dir, peer, instance->migrationProgress,
+                         (instance->migrationPostCopy ? " post-copy" : ""));
+            } else {
+                snprintf(status_str, sizeof(status_str), "%s %c%s", migration_state_names[instance->migration_state], dir, peer);
+            }
         } else if (instance->terminationTime) {
             strncpy(status_str, "terminated", sizeof(status_str));
         } else if (instance->terminationRequestedTime) {
@@ -3098,6 +6329,9 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncIn
             fprintf(f, "memory (max/avail/used) MB: %lld/%lld/%lld\n", nc_state.mem_max, nc_state.mem_max - used_mem, used_mem);
             fprintf(f, "disk (max/avail/used) GB: %lld/%lld/%lld\n", nc_state.disk_max, nc_state.disk_max - used_disk, used_disk);
             fprintf(f, "cores (max/avail/used): %lld/%lld/%lld\n", nc_state.cores_max, nc_state.cores_max - used_cores, used_cores);
+            print_numa_nodes(f, (*outInsts), (*outInstsLen));
+            print_memory_density(f);
+            print_launch_stages(f);
 
             for (i = 0; i < (*outInstsLen); i++) {
                 ncInstance *instance = (*outInsts)[i];
@@ -3108,7 +6342,12 @@ int doDescribeInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, ncIn
                 fprintf(f, " disk: %d", instance->params.disk);
                 fprintf(f, " cores: %d", instance->params.cores);
                 fprintf(f, " private: %s", instance->ncnet.privateIp);
-                fprintf(f, " public: %s\n", instance->ncnet.publicIp);
+                fprintf(f, " public: %s", instance->ncnet.publicIp);
+                if ((instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, instance->migration_src)) {
+                    fprintf(f, " migration: %d%% remainingMB: %lld dirtyMBs: %lld%s", instance->migrationProgress, instance->migrationRemainingBytes / MEGABYTE,
+                            instance->migrationDirtyRate / MEGABYTE, (instance->migrationPostCopy ? " post-copy" : ""));
+                }
+                fprintf(f, "\n");
             }
             fclose(f);
         }
@@ -3331,6 +6570,89 @@ int doRebootInstance(ncMetadata * pMeta, char *instanceId)
     return ret;
 }
 
+//!
+//! Terminates a list of instances in one request, releasing their public addresses as well,
+//! which saves the CC a call per instance. The terminations go to the termination thread
+//! together, so it shuts down the domains and tears down their disks as a batch.
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to terminate
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[in]  force if set to 1 will force the termination of the instances
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, set to 0 for the instances whose
+//!             termination was queued and to 1 for the others
+//!
+//! @return EUCA_OK if the list could be handled, even if some of the instances failed, or EUCA_ERROR.
+//!
+int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int *outStatus)
+{
+    int rc = EUCA_OK;
+    int shutdownState = 0;
+    int previousState = 0;
+
+    if (init())
+        return (EUCA_ERROR);
+    DISABLED_CHECK;
+
+    LOGINFO("termination of %d instances requested\n", instIdsLen);
+
+    for (int i = 0; i < instIdsLen; i++) {
+        LOGDEBUG("[%s] termination requested\n", instIds[i]);
+        if (nc_state.H->doTerminateInstance)
+            rc = nc_state.H->doTerminateInstance(&nc_state, pMeta, instIds[i], force, &shutdownState, &previousState);
+        else
+            rc = nc_state.D->doTerminateInstance(&nc_state, pMeta, instIds[i], force, &shutdownState, &previousState);
+        if (rc == EUCA_OK) {
+            if (nc_state.H->doAssignAddress)
+                nc_state.H->doAssignAddress(&nc_state, pMeta, instIds[i], "0.0.0.0");
+            else
+                nc_state.D->doAssignAddress(&nc_state, pMeta, instIds[i], "0.0.0.0");
+        } else {
+            LOGWARN("[%s] failed to terminate instance error=%d\n", instIds[i], rc);
+        }
+        if (outStatus)
+            outStatus[i] = ((rc == EUCA_OK) ? 0 : 1);
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//! Reboots a list of instances in one request
+//!
+//! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
+//! @param[in]  instIds the identifiers of the instances to reboot
+//! @param[in]  instIdsLen the number of identifiers in the instIds list
+//! @param[out] outStatus OPTIONAL array of instIdsLen entries, set to 0 for the instances that
+//!             are rebooting and to 1 for the others
+//!
+//! @return EUCA_OK if the list could be handled, even if some of the instances failed, or EUCA_ERROR.
+//!
+int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int *outStatus)
+{
+    int rc = EUCA_OK;
+
+    if (init())
+        return (EUCA_ERROR);
+    DISABLED_CHECK;
+
+    LOGINFO("rebooting of %d instances requested\n", instIdsLen);
+
+    for (int i = 0; i < instIdsLen; i++) {
+        LOGDEBUG("[%s] rebooting requested\n", instIds[i]);
+        if (nc_state.H->doRebootInstance)
+            rc = nc_state.H->doRebootInstance(&nc_state, pMeta, instIds[i]);
+        else
+            rc = nc_state.D->doRebootInstance(&nc_state, pMeta, instIds[i]);
+        if (rc != EUCA_OK)
+            LOGWARN("[%s] failed to reboot instance error=%d\n", instIds[i], rc);
+        if (outStatus)
+            outStatus[i] = ((rc == EUCA_OK) ? 0 : 1);
+    }
+
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the get console output request
 //!
@@ -99,6 +99,7 @@
 #define MAXDOMS                          1024   //!< Maximum number of domain
 #define BYTES_PER_DISK_UNIT              1073741824 //!< describeResource disk units are GBs
 #define MB_PER_DISK_UNIT                 1024   //!< describeResource disk units are GBs
+#define MAX_NUMA_NODES                   64 //!< Maximum number of NUMA nodes of the host the NC places instances on
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -118,6 +119,16 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A NUMA node of the host, as seen by instance placement
+typedef struct ncNumaNode_t {
+    int id;                            //!< number of the node in /sys/devices/system/node
+    char cpus[CHAR_BUFFER_SIZE];       //!< CPUs of the node, as a libvirt cpuset
+    int cores_max;                     //!< share of the virtual cores of the NC that belongs to this node
+    long long mem_max;                 //!< share of the memory of the NC, in MB, that belongs to this node
+    int cores_free;                    //!< cores not taken by instances pinned to the node, as of the last placement
+    long long mem_free;                //!< memory, in MB, not taken by instances pinned to the node, as of the last placement
+} ncNumaNode;
+
 //! NC State structure
 struct nc_state_t {
     boolean is_enabled;                //!< flag determining if the node controller is enabled
@@ -140,15 +151,41 @@ struct nc_state_t {
     boolean convert_to_disk;
     boolean do_inject_key;
     int concurrent_disk_ops, concurrent_cleanup_ops;
+    int concurrent_launch_fetch, concurrent_launch_prepare, concurrent_launch_define, concurrent_launch_boot;
     int sc_request_timeout_sec;
+    int use_sc_pool;
+    int createimage_live;
     int disable_snapshots;
+    int thin_snapshots;
+    int reclaim_sparse_blocks;
+    char cache_io_policy[SMALL_CHAR_BUFFER_SIZE];
+    char work_io_policy[SMALL_CHAR_BUFFER_SIZE];
+    int prestage_bandwidth_mbs;
+    char fast_cache_path[EUCA_MAX_PATH];    //!< directory of the fast tier of the cache, empty for none
+    int fast_cache_size_mb;
+    int lazy_boot;
+    int lazy_pull_bandwidth_mbs;
+    int compress_cached_images;
+    int stream_image_downloads;
     int staging_cleanup_threshold;
     int booting_cleanup_threshold;
     int bundling_cleanup_threshold;
     int createImage_cleanup_threshold;
     int teardown_state_duration;
     int migration_ready_threshold;
+    int migration_max_outgoing;
+    int migration_bandwidth_mbs;
+    int migration_auto_converge;
+    char migration_compression[SMALL_CHAR_BUFFER_SIZE];
+    int migration_postcopy_after_sec;
+    int migration_keys_ttl_sec;        //!< how long migration keys are reused for the same peer and secret, 0 to redo them every time
     int shutdown_grace_period_sec;
+    boolean numa_pinning;
+    int huge_pages_kb;
+    boolean memory_density;            //!< KVM: memory is handed out on what the instances actually use, see density_mem_free()
+    double mem_overcommit_ratio;       //!< with memory_density, most memory promised to instances as a multiple of mem_max
+    int numa_nodes_len;
+    ncNumaNode numa_nodes[MAX_NUMA_NODES];
     boolean migration_capable;
     //! @}
 
@@ -189,6 +226,11 @@ struct nc_state_t {
     int config_use_virtio_net;         //!< KVM: use virtio for network
     int config_use_virtio_disk;        //!< KVM: use virtio for disk attachment
     int config_use_virtio_root;        //!< KVM: use virtio for root partition
+    int config_virtio_net_queues;      //!< KVM: most queues per virtio NIC, capped by the cores of the instance (0 or 1 for a single queue)
+    int config_virtio_net_ring_size;   //!< KVM: size of the receive ring of each virtio NIC queue (0 for the hypervisor default)
+    int config_virtio_iothreads;       //!< KVM: number of I/O threads the virtio disks of an instance are spread over (0 for none)
+    char config_virtio_tuned_vm_types[CHAR_BUFFER_SIZE];    //!< KVM: VM types the three settings above apply to (empty for all)
+    int config_balloon_stats_period;   //!< KVM: seconds between the memory statistics updates of the virtio balloon of the guests (0 for none)
     //! @}
 
     //! @{
@@ -273,14 +315,26 @@ struct bundling_params_t {
  //! image structure
 struct createImage_params_t {
     ncInstance *instance;
+    struct nc_state_t *nc;             //!< the NC state (only set for a live copy)
     char *volumeId;
     char *remoteDev;
+    char *diskName;                    //!< guest disk copied by a live createImage (e.g., vda)
     char *workPath;                    //!< work directory path
     char *diskPath;                    //!< disk file path
     char *eucalyptusHomePath;
     long long sizeMb;                  //!< diskPath size
 };
 
+//! Immutable snapshot of the instance list, published by copy_instances() for Describe* requests
+typedef struct instancesSnapshot_t {
+    int refs;                          //!< number of readers holding the snapshot, plus one while it is the published one
+    int instancesLen;                  //!< number of instances in the snapshot
+    ncInstance **instances;            //!< read-only copies of the instances, shared with other snapshots while unchanged
+    long long sum_mem;                 //!< memory, in MB, requested by the instances that take up resources (all but TEARDOWN)
+    long long sum_disk;                //!< disk, in GB, used by the instances that take up resources
+    int sum_cores;                     //!< cores requested by the instances that take up resources
+} instancesSnapshot;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -315,6 +369,8 @@ int doRunInstance(ncMetadata * pMeta, char *uuid, char *instanceId, char *reserv
                   char *rootDirective, ncInstance ** outInst);
 int doTerminateInstance(ncMetadata * pMeta, char *instanceId, int force, int *shutdownState, int *previousState);
 int doRebootInstance(ncMetadata * pMeta, char *instanceId);
+int doTerminateInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int force, int *outStatus);
+int doRebootInstances(ncMetadata * pMeta, char **instIds, int instIdsLen, int *outStatus);
 int doGetConsoleOutput(ncMetadata * pMeta, char *instanceId, char **consoleOutput);
 int doDescribeResource(ncMetadata * pMeta, char *resourceType, ncResource ** outRes);
 int doStartNetwork(ncMetadata * pMeta, char *uuid, char **remoteHosts, int remoteHostsLen, int port, int vlan);
@@ -343,6 +399,9 @@ int canonicalize_dev(const char *dev, char *cdev, int cdev_len);
 void print_running_domains(void);
 virConnectPtr lock_hypervisor_conn(void);
 void unlock_hypervisor_conn(void);
+virConnectPtr lock_hypervisor_query_conn(void);
+void unlock_hypervisor_query_conn(virConnectPtr conn);
+long long density_mem_free(long long sum_mem);
 void change_state(ncInstance * instance, instance_states state);
 int wait_state_transition(ncInstance * instance, instance_states from_state, instance_states to_state);
 void adopt_instances();
@@ -350,8 +409,12 @@ int get_instance_xml(const char *gen_libvirt_cmd_path, char *userId, char *insta
                      char *disk_path, virtualMachine * params, char *privMac, char *brname, int use_virtio_net, int use_virtio_root, char **xml);
 void set_instance_params(ncInstance * instance);
 void *monitoring_thread(void *arg);
+void *reclaiming_thread(void *arg);
+void *prestaging_thread(void *arg);
+void *tiering_thread(void *arg);
 void *startup_thread(void *arg);
 void *terminating_thread(void *arg);
+int queue_termination(const char *instanceId);
 
 int get_instance_stats(virDomainPtr dom, ncInstance * instance);
 ncInstance *find_global_instance(const char *instanceId);
@@ -360,12 +423,22 @@ int find_and_stop_instance(char *psInstanceId);
 int find_and_start_instance(char *psInstanceId);
 int shutdown_then_destroy_domain(const char *instanceId, boolean do_destroy);
 void copy_instances(void);
+long long get_instances_generation(void);
+instancesSnapshot *acquire_instances_snapshot(void);
+void release_instances_snapshot(instancesSnapshot * snapshot);
+ncInstance *ref_instance_copy(ncInstance * instance);
+void release_instance_copy(ncInstance * instance);
 int is_migration_dst(const ncInstance * instance);
 int is_migration_src(const ncInstance * instance);
 int migration_rollback(ncInstance * instance);
 int get_service_url(const char *service_type, struct nc_state_t *nc, char *dest_buffer);
 int authorize_migration_keys(char *options, char *host, char *credentials, ncInstance * instance, boolean lock_hyp_sem);
+boolean migration_keys_current(const char *host, const char *credentials);
+void migration_keys_generated(const char *host, const char *credentials, boolean restarted);
+int deauthorize_migration_keys(void);
+void expire_migration_keys(void);
 int connect_ebs(const char *dev_name, const char *dev_serial, const char *dev_bus, struct nc_state_t *nc, char *instanceId, char *volumeId, char *attachmentToken, char **libvirt_xml, ebs_volume_data ** vol_data);
+int connect_ebs_volumes(struct nc_state_t *nc, char *instanceId, ncVolume ** volumes, int count);
 int disconnect_ebs(struct nc_state_t *nc, char *instanceId, char *volumeId, char *attachmentToken, char *connect_string);
 void set_serial_and_bus(const char *vol, const char *dev, char *serial, int serial_len, char *bus, int bus_len);
 
@@ -98,6 +98,9 @@
 #include <libvirt/virterror.h>
 #include <ctype.h>
 #include <linux/limits.h>
+#if defined(HAVE_ZLIB_H)
+#include <zlib.h>
+#endif /* HAVE_ZLIB_H */
 
 #include <eucalyptus.h>
 #include <ipc.h>
@@ -109,6 +112,7 @@
 #include <sensor.h>
 #include <euca_string.h>
 #include <euca_file.h>
+#include <hash.h>
 
 #include "handlers.h"
 #include "xml.h"
@@ -124,6 +128,8 @@
 
 #define VOL_RETRIES 3
 #define SHUTDOWN_GRACE_PERIOD_SEC 60
+#define CREATEIMAGE_LIVE_POLL_SEC 2    //!< how often, in seconds, the block copy job of a live createImage is checked
+#define CREATEIMAGE_LIVE_LOG_SEC 60    //!< how often, in seconds, the progress of a live createImage is logged
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -149,6 +155,16 @@ typedef struct startstop_params_ {
     boolean do_stop;
 } startstop_params;
 
+//! One volume being connected by connect_ebs_volumes()
+typedef struct ebsConnectJob_t {
+    struct nc_state_t *nc;             //!< the NC state
+    char *instanceId;                  //!< the instance the volume is attached to
+    ncVolume *volume;                  //!< the volume, its connection string is updated once connected
+    pthread_t tcb;                     //!< the thread connecting the volume
+    boolean started;                   //!< set if the thread was started
+    int ret;                           //!< result of connect_ebs()
+} ebsConnectJob;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -160,9 +176,7 @@ typedef struct startstop_params_ {
 // coming from handlers.c
 extern sem *hyp_sem;
 extern sem *inst_sem;
-extern sem *inst_copy_sem;
 extern bunchOfInstances *global_instances;
-extern bunchOfInstances *global_instances_copy;
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -214,6 +228,10 @@ static int doDetachVolume(struct nc_state_t *nc, ncMetadata * pMeta, char *insta
 static void change_createImage_state(ncInstance * instance, createImage_progress state);
 static int cleanup_createImage_task(ncInstance * instance, struct createImage_params_t *params, instance_states state, createImage_progress result);
 static void *createImage_thread(void *arg);
+#if LIBVIR_VERSION_NUMBER >= 1002008
+static int createImage_live_copy(struct nc_state_t *nc, ncInstance * instance, char *volumeId, char *attachmentToken, const char *disk);
+static void *createImage_live_thread(void *arg);
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
 static int doCreateImage(struct nc_state_t *nc, ncMetadata * pMeta, char *instanceId, char *volumeId, char *remoteDev);
 static void change_bundling_state(ncInstance * instance, bundling_progress state);
 static int cleanup_bundling_task(ncInstance * instance, struct bundling_params_t *params, bundling_progress result);
@@ -592,21 +610,21 @@ int find_and_stop_instance(char *psInstanceId)
     LOGDEBUG("[%s] stopping instance\n", psInstanceId);
 
     {
-        // we hold hyp_sem in this block
-        if ((conn = lock_hypervisor_conn()) == NULL) {
+        // we hold a reference to the query connection in this block
+        if ((conn = lock_hypervisor_query_conn()) == NULL) {
             LOGERROR("[%s] cannot connect to hypervisor to stop instance, giving up\n", psInstanceId);
             return (EUCA_ERROR);
         }
 
         if ((dom = virDomainLookupByName(conn, psInstanceId)) == NULL) {
             LOGERROR("[%s] cannot locate instance to stop, giving up\n", psInstanceId);
-            unlock_hypervisor_conn();
+            unlock_hypervisor_query_conn(conn);
             return (EUCA_NOT_FOUND_ERROR);
         }
         // obtain the most up-to-date XML for domain from libvirt
         psXML = virDomainGetXMLDesc(dom, 0);
         virDomainFree(dom);            // release libvirt resource
-        unlock_hypervisor_conn();
+        unlock_hypervisor_query_conn(conn);
     }
 
     if (psXML == NULL) {
@@ -744,7 +762,7 @@ int find_and_start_instance(char *psInstanceId)
 //! @param[out] shutdownState hard-coded to 0 on success
 //! @param[out] previousState hard-coded to 0 on success
 //!
-//! @return EUCA_OK if instanceId is valid and the termination thread could be spawned
+//! @return EUCA_OK if instanceId is valid and the termination could be queued
 //!
 //! @see find_and_terminate_instance()
 //!
@@ -769,16 +787,8 @@ static int doTerminateInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *
 
     refresh_instance_resources(instanceId);
 
-    // do the shutdown in a thread
-    pthread_attr_t tattr;
-    pthread_t tid;
-    pthread_attr_init(&tattr);
-    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
-    void *param = (void *)strdup(instanceId);
-    if (pthread_create(&tid, &tattr, terminating_thread, (void *)param) != 0) {
-        LOGERROR("[%s] failed to start VM termination thread\n", instanceId);
-    } else {
-        set_corrid_pthread(get_corrid() != NULL ? get_corrid()->correlation_id : NULL, tid);
+    // do the shutdown in the termination thread, together with any other instances being terminated
+    if (queue_termination(instanceId) == EUCA_OK) {
         // previous and shutdown state are ignored by CC anyway
         *previousState = 0;
         *shutdownState = 0;
@@ -803,7 +813,7 @@ static int doTerminateInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *
 static int doDescribeInstances(struct nc_state_t *nc, ncMetadata * pMeta, char **instIds, int instIdsLen, ncInstance *** outInsts, int *outInstsLen)
 {
     ncInstance *instance = NULL;
-    ncInstance *tmp = NULL;
+    instancesSnapshot *snapshot = NULL;
     int total = 0;
     int i = 0;
     int j = 0;
@@ -815,20 +825,24 @@ static int doDescribeInstances(struct nc_state_t *nc, ncMetadata * pMeta, char *
     *outInstsLen = 0;
     *outInsts = NULL;
 
-    sem_p(inst_copy_sem);
+    if ((snapshot = acquire_instances_snapshot()) == NULL)
+        return EUCA_OK;                // nothing published yet, so no instances
+
     if (instIdsLen == 0)               // describe all instances
-        total = total_instances(&global_instances_copy);
+        total = snapshot->instancesLen;
     else
         total = instIdsLen;
 
     *outInsts = EUCA_ZALLOC(total, sizeof(ncInstance *));
     if ((*outInsts) == NULL) {
-        sem_v(inst_copy_sem);
+        release_instances_snapshot(snapshot);
         return EUCA_MEMORY_ERROR;
     }
 
     k = 0;
-    for (i = 0; (instance = get_instance(&global_instances_copy)) != NULL; i++) {
+    for (i = 0; i < snapshot->instancesLen; i++) {
+        instance = snapshot->instances[i];
+
         // only pick ones the user (or admin) is allowed to see
         if (strcmp(pMeta->userId, nc->admin_user_id)
             && strcmp(pMeta->userId, instance->userId))
@@ -843,37 +857,15 @@ static int doDescribeInstances(struct nc_state_t *nc, ncMetadata * pMeta, char *
                 // instance of no relevance right now
                 continue;
         }
-        // (* outInsts)[k++] = instance;
-        tmp = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance));
-        memcpy(tmp, instance, sizeof(ncInstance));
-        (*outInsts)[k++] = tmp;
+        // the reply shares the read-only copy, which the caller releases with release_instance_copy()
+        (*outInsts)[k++] = ref_instance_copy(instance);
     }
     *outInstsLen = k;
-    sem_v(inst_copy_sem);
+    release_instances_snapshot(snapshot);
 
     return EUCA_OK;
 }
 
-//!
-//! Adds up NC disk usage for an instance
-//!
-static long long get_disk_use_gb(virtualMachine *vm)
-{
-    long long disk_use_bytes = 0L;
-
-    for (int i = 0; i < EUCA_MAX_VBRS && i < vm->virtualBootRecordLen; i++) {
-        virtualBootRecord *vbr = &(vm->virtualBootRecord[i]);
-        if (vbr->type != NC_RESOURCE_EBS && // EBS volumes do not count
-            vbr->type != NC_RESOURCE_KERNEL && // EKI doesn't count, though it maybe should
-            vbr->type != NC_RESOURCE_RAMDISK && // ERI doesn't count, though it maybe should
-            vbr->type != NC_RESOURCE_BOOT) { // boot sector is too small to be worth counting
-            disk_use_bytes += vbr->sizeBytes;
-        }
-    }
-
-    return disk_use_bytes/(1024*1024*1024);
-}
-
 //!
 //! Describe the resources status for this component
 //!
@@ -888,9 +880,10 @@ static long long get_disk_use_gb(virtualMachine *vm)
 static int doDescribeResource(struct nc_state_t *nc, ncMetadata * pMeta, char *resourceType, ncResource ** outRes)
 {
     ncResource *res = NULL;
-    ncInstance *inst = NULL;
+    instancesSnapshot *snapshot = NULL;
 
     // stats to re-calculate now
+    long long mem_max = nc->mem_max;
     long long mem_free = 0;
     long long disk_free = 0;
     int cores_free = 0;
@@ -916,15 +909,13 @@ static int doDescribeResource(struct nc_state_t *nc, ncMetadata * pMeta, char *r
         }
     }
 
-    sem_p(inst_copy_sem);
-    while ((inst = get_instance(&global_instances_copy)) != NULL) {
-        if (inst->state == TEARDOWN)
-            continue;                  // they don't take up resources
-        sum_mem += inst->params.mem;
-        sum_disk += get_disk_use_gb(&(inst->params));
-        sum_cores += inst->params.cores;
+    // the sums are kept up to date by copy_instances() as instances come, go and change
+    if ((snapshot = acquire_instances_snapshot()) != NULL) {
+        sum_mem = snapshot->sum_mem;
+        sum_disk = snapshot->sum_disk;
+        sum_cores = snapshot->sum_cores;
+        release_instances_snapshot(snapshot);
     }
-    sem_v(inst_copy_sem);
 
     disk_free = nc->disk_max - sum_disk;
     if (disk_free < 0)
@@ -934,20 +925,26 @@ static int doDescribeResource(struct nc_state_t *nc, ncMetadata * pMeta, char *r
     if (cores_free < 0)
         cores_free = 0;                // due to timesharing
 
-    mem_free = nc->mem_max - sum_mem;
-    if (mem_free < 0)
-        mem_free = 0;                  // should not happen
+    if (nc->memory_density) {
+        // in density mode the CC packs instances on the memory they actually use, up to the overcommit ratio
+        mem_max = (long long)(nc->mem_max * nc->mem_overcommit_ratio);
+        mem_free = density_mem_free(sum_mem);
+    } else {
+        mem_free = nc->mem_max - sum_mem;
+        if (mem_free < 0)
+            mem_free = 0;              // should not happen
+    }
 
     // check for potential overflow - should not happen
-    if (nc->mem_max > INT_MAX || mem_free > INT_MAX || nc->disk_max > INT_MAX || disk_free > INT_MAX) {
+    if (mem_max > INT_MAX || mem_free > INT_MAX || nc->disk_max > INT_MAX || disk_free > INT_MAX) {
         LOGERROR("stats integer overflow error (bump up the units?)\n");
-        LOGERROR("   memory: max=%-10lld free=%-10lld\n", nc->mem_max, mem_free);
+        LOGERROR("   memory: max=%-10lld free=%-10lld\n", mem_max, mem_free);
         LOGERROR("     disk: max=%-10lld free=%-10lld\n", nc->disk_max, disk_free);
         LOGERROR("    cores: max=%-10lld free=%-10d\n", nc->cores_max, cores_free);
         LOGERROR("       INT_MAX=%-10d\n", INT_MAX);
         return EUCA_OVERFLOW_ERROR;
     }
-    res = allocate_resource(nc->is_enabled ? "enabled" : "disabled", nc->migration_capable, nc->iqn, nc->mem_max, mem_free, nc->disk_max, disk_free, nc->cores_max, cores_free,
+    res = allocate_resource(nc->is_enabled ? "enabled" : "disabled", nc->migration_capable, nc->iqn, mem_max, mem_free, nc->disk_max, disk_free, nc->cores_max, cores_free,
                             "none", "KVM");
     if (res == NULL) {
         LOGERROR("out of memory\n");
@@ -963,17 +960,76 @@ static int doDescribeResource(struct nc_state_t *nc, ncMetadata * pMeta, char *r
 }
 
 //!
-//! Accepts a broadcast of global network info
+//! Inflates the compressed form of the network info, see NETWORK_INFO_ZLIB_PREFIX
+//!
+//! @param[in] networkInfo the compressed form
+//!
+//! @return the network info XML, to be freed by the caller, or NULL if it cannot be inflated or does
+//!         not match its version
+//!
+static char *unpack_network_info(const char *networkInfo)
+{
+#if defined(HAVE_ZLIB_H)
+    int rc = 0;
+    int zlen = 0;
+    char *end = NULL;
+    char *zbuf = NULL;
+    char *xml = NULL;
+    const char *p = networkInfo + strlen(NETWORK_INFO_ZLIB_PREFIX);
+    const char *sep = NULL;
+    char version[NETWORK_INFO_VERSION_LEN] = "";
+    char check[NETWORK_INFO_VERSION_LEN] = "";
+    uLongf len = 0;
+
+    // "<MD5>:<length>:<base64 of the deflated XML>"
+    if (((sep = strchr(p, ':')) == NULL) || ((sep - p) >= sizeof(version)))
+        return (NULL);
+    euca_strncpy(version, p, ((sep - p) + 1));
+
+    len = strtoul((sep + 1), &end, 10);
+    if ((end == (sep + 1)) || (*end != ':') || (len == 0) || (len > NETWORK_INFO_MAX_XML))
+        return (NULL);
+
+    if ((zbuf = base64_dec2((u8 *) (end + 1), strlen(end + 1), &zlen)) == NULL)
+        return (NULL);
+
+    if ((xml = EUCA_ALLOC((len + 1), sizeof(char))) != NULL) {
+        if ((rc = uncompress(((Bytef *) xml), &len, ((const Bytef *)zbuf), zlen)) != Z_OK) {
+            LOGERROR("cannot inflate network info %s (%d)\n", version, rc);
+            EUCA_FREE(xml);
+        } else {
+            xml[len] = '\0';
+            if ((str2md5str(check, sizeof(check), xml) != EUCA_OK) || strcmp(check, version)) {
+                LOGERROR("network info does not match its version %s\n", version);
+                EUCA_FREE(xml);
+            }
+        }
+    }
+    EUCA_FREE(zbuf);
+    return (xml);
+#else /* HAVE_ZLIB_H */
+    LOGDEBUG("cannot take compressed network info, asking for it as is\n");
+    return (NULL);
+#endif /* HAVE_ZLIB_H */
+}
+
+//!
+//! Accepts a broadcast of global network info. Besides the base64 encoded XML, the CC may send
+//! the compressed form or, when it believes the network info has not changed, a version token.
+//! A token that does not match the XML in place is turned down, so that the CC sends the XML.
 //!
 //! @param[in] nc a pointer to the NC state structure
 //! @param[in] pMeta a pointer to the node controller (NC) metadata structure
 //! @param[in] networkInfo is a string
 //!
-//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_INVALID_ERROR.
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_INVALID_ERROR
+//!         and EUCA_NOT_FOUND_ERROR (for a version this NC does not have).
 //!
 static int doBroadcastNetworkInfo(struct nc_state_t *nc, ncMetadata * pMeta, char *networkInfo)
 {
     char *xmlbuf = NULL, xmlpath[EUCA_MAX_PATH];
+    char *version = NULL;
+    char newversion[NETWORK_INFO_VERSION_LEN] = "";
     int ret = EUCA_OK, rc = 0;
 
     if (networkInfo == NULL) {
@@ -983,17 +1039,46 @@ static int doBroadcastNetworkInfo(struct nc_state_t *nc, ncMetadata * pMeta, cha
 
     LOGTRACE("encoded networkInfo=%s\n", networkInfo);
     snprintf(xmlpath, EUCA_MAX_PATH, EUCALYPTUS_STATE_DIR "/global_network_info.xml", nc->home);
-    LOGDEBUG("decoding/writing buffer to (%s)\n", xmlpath);
-    xmlbuf = base64_dec((unsigned char *)networkInfo, strlen(networkInfo));
+
+    if (!strncmp(networkInfo, NETWORK_INFO_VERSION_PREFIX, strlen(NETWORK_INFO_VERSION_PREFIX))) {
+        // nothing changed, as far as the CC can tell
+        version = file2md5str(xmlpath);
+        if (!version || strcmp(version, (networkInfo + strlen(NETWORK_INFO_VERSION_PREFIX)))) {
+            LOGDEBUG("network info %s is not in place (have %s), asking for it\n", (networkInfo + strlen(NETWORK_INFO_VERSION_PREFIX)), SP(version));
+            ret = EUCA_NOT_FOUND_ERROR;
+        }
+        EUCA_FREE(version);
+        return (ret);
+    }
+
+    if (!strncmp(networkInfo, NETWORK_INFO_ZLIB_PREFIX, strlen(NETWORK_INFO_ZLIB_PREFIX))) {
+        xmlbuf = unpack_network_info(networkInfo);
+    } else {
+        xmlbuf = base64_dec((unsigned char *)networkInfo, strlen(networkInfo));
+    }
+
     if (xmlbuf) {
-        rc = str2file(xmlbuf, xmlpath, O_CREAT | O_TRUNC | O_WRONLY, 0600, FALSE);
-        if (rc) {
-            LOGERROR("could not write XML data to file (%s)\n", xmlpath);
-            ret = EUCA_ERROR;
+        // eucanetd has nothing to re-apply when the XML in place is the same
+        version = file2md5str(xmlpath);
+        if (version && (str2md5str(newversion, sizeof(newversion), xmlbuf) == EUCA_OK) && !strcmp(version, newversion)) {
+            LOGDEBUG("network info %s already in place\n", version);
+        } else {
+            LOGDEBUG("decoding/writing buffer to (%s)\n", xmlpath);
+            rc = str2file(xmlbuf, xmlpath, O_CREAT | O_TRUNC | O_WRONLY, 0600, FALSE);
+            if (rc) {
+                LOGERROR("could not write XML data to file (%s)\n", xmlpath);
+                ret = EUCA_ERROR;
+            } else {
+                // let eucanetd apply it now rather than on its next poll
+                EUCA_FREE(version);
+                version = file2md5str(xmlpath);
+                vnetNotifyEucanetd(nc->home, version);
+            }
         }
+        EUCA_FREE(version);
         EUCA_FREE(xmlbuf);
     } else {
-        LOGERROR("could not b64 decode input buffer\n");
+        LOGERROR("could not decode input buffer\n");
         ret = EUCA_ERROR;
     }
 
@@ -1237,6 +1322,94 @@ int disconnect_ebs(struct nc_state_t *nc, char *instanceId, char *volumeId, char
     return ret;
 }
 
+//!
+//! Thread connecting one volume of connect_ebs_volumes()
+//!
+//! @param[in] arg the ebsConnectJob of the volume
+//!
+//! @return NULL
+//!
+static void *connect_ebs_thread(void *arg)
+{
+    char serial[128] = "";
+    char bus[16] = "";
+    char *libvirt_xml = NULL;
+    ebsConnectJob *job = ((ebsConnectJob *) arg);
+    ncVolume *volume = job->volume;
+    ebs_volume_data *vol_data = NULL;
+
+    set_serial_and_bus(volume->volumeId, volume->devName, serial, sizeof(serial), bus, sizeof(bus));
+    if ((job->ret = connect_ebs(volume->devName, serial, bus, job->nc, job->instanceId, volume->volumeId, volume->attachmentToken, &libvirt_xml, &vol_data)) == EUCA_OK) {
+        // update the volume struct with connection string obtained from SC
+        euca_strncpy(volume->connectionString, vol_data->connect_string, sizeof(volume->connectionString));
+    }
+    EUCA_FREE(libvirt_xml);
+    EUCA_FREE(vol_data);
+    return (NULL);
+}
+
+//!
+//! Connects several EBS volumes to the local host at once, each in its own thread, so that
+//! the SC round-trips and target logins of the volumes overlap. If any of them fails, the
+//! ones that were connected are disconnected again.
+//!
+//! @param[in] nc         a pointer to the NC state structure
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//! @param[in] volumes    the volumes to connect, their connection strings are updated
+//! @param[in] count      the number of volumes
+//!
+//! @return EUCA_OK if all volumes were connected or EUCA_ERROR otherwise
+//!
+int connect_ebs_volumes(struct nc_state_t *nc, char *instanceId, ncVolume ** volumes, int count)
+{
+    int i = 0;
+    int ret = EUCA_OK;
+    ebsConnectJob *jobs = NULL;
+
+    if (count < 1)
+        return (EUCA_OK);
+
+    if ((jobs = EUCA_ZALLOC(count, sizeof(ebsConnectJob))) == NULL) {
+        LOGERROR("[%s] out of memory\n", instanceId);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    LOGDEBUG("[%s] connecting %d EBS volume(s)\n", instanceId, count);
+    for (i = 0; i < count; i++) {
+        jobs[i].nc = nc;
+        jobs[i].instanceId = instanceId;
+        jobs[i].volume = volumes[i];
+        if (count == 1) {
+            connect_ebs_thread(&jobs[i]);
+        } else if (pthread_create(&(jobs[i].tcb), NULL, connect_ebs_thread, &jobs[i]) == 0) {
+            jobs[i].started = TRUE;
+        } else {
+            LOGWARN("[%s][%s] failed to start a thread, connecting volume inline\n", instanceId, volumes[i]->volumeId);
+            connect_ebs_thread(&jobs[i]);
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (jobs[i].started)
+            pthread_join(jobs[i].tcb, NULL);
+        if (jobs[i].ret != EUCA_OK) {
+            LOGERROR("[%s][%s] failed to connect EBS volume\n", instanceId, volumes[i]->volumeId);
+            ret = EUCA_ERROR;
+        }
+    }
+
+    if (ret != EUCA_OK) {
+        for (i = 0; i < count; i++) {
+            if (jobs[i].ret == EUCA_OK) {
+                disconnect_ebs(nc, instanceId, volumes[i]->volumeId, volumes[i]->attachmentToken, volumes[i]->connectionString);
+            }
+        }
+    }
+
+    EUCA_FREE(jobs);
+    return (ret);
+}
+
 int get_instance_path(const char *instanceId, char *path, int path_len)
 {
     int ret = EUCA_OK;
@@ -1341,7 +1514,21 @@ int attach_vol_instance(struct nc_state_t *nc, const char *devName, const char *
         if (err) {
             LOGERROR("[%s][%s] failed to attach EBS guest device on attempt %d of 3\n", instanceId, volumeId, i);
             LOGDEBUG("[%s][%s] virDomainAttachDevice() failed (err=%d) XML='%s'\n", instanceId, volumeId, err, libvirt_xml);
-            sleep(3);              // sleep a bit and retry.
+            if (i == VOL_RETRIES)
+                break;
+
+            // sleep a bit and retry, without keeping other volumes and instances off the hypervisor meanwhile
+            virDomainFree(dom);
+            unlock_hypervisor_conn();
+            sleep(3);
+            if ((conn = lock_hypervisor_conn()) == NULL) {
+                LOGERROR("[%s][%s] cannot get connection to hypervisor\n", instanceId, volumeId);
+                return EUCA_HYPERVISOR_ERROR;
+            }
+            if ((dom = virDomainLookupByName(conn, instanceId)) == NULL) {
+                unlock_hypervisor_conn();
+                return EUCA_HYPERVISOR_ERROR;
+            }
         } else {
             break;
         }
@@ -1613,6 +1800,7 @@ static int cleanup_createImage_task(ncInstance * instance, struct createImage_pa
         EUCA_FREE(params->workPath);
         EUCA_FREE(params->volumeId);
         EUCA_FREE(params->remoteDev);
+        EUCA_FREE(params->diskName);
         EUCA_FREE(params->diskPath);
         EUCA_FREE(params->eucalyptusHomePath);
         EUCA_FREE(params);
@@ -1668,9 +1856,159 @@ static void *createImage_thread(void *arg)
     return NULL;
 }
 
+#if LIBVIR_VERSION_NUMBER >= 1002008
+//!
+//! Copies a disk of a running KVM instance to an EBS volume with a libvirt block copy job.
+//! QEMU mirrors the disk to the volume in the background while the guest keeps running.
+//! Once the mirror is in sync, ending the job (without pivoting the guest to the copy)
+//! leaves the volume with an image of the disk as of that moment. The file systems of
+//! the guest are frozen, through the guest agent if it runs one, for that moment only.
+//!
+//! @param[in] nc a pointer to the NC state structure
+//! @param[in] instance a pointer to the instance
+//! @param[in] volumeId the volume identifier string (vol-XXXXXXXX)
+//! @param[in] attachmentToken the token string for the attachment of the volume
+//! @param[in] disk the guest device name of the disk to copy (e.g., vda)
+//!
+//! @return 0 on success, -1 if the copy was cancelled or 1 on failure
+//!
+static int createImage_live_copy(struct nc_state_t *nc, ncInstance * instance, char *volumeId, char *attachmentToken, const char *disk)
+{
+    int rc = 1;
+    int jobrc = 0;
+    int frozen = 0;
+    boolean started = FALSE;
+    boolean done = FALSE;
+    char bus[16] = "";
+    char serial[128] = "";
+    char *instanceId = instance->instanceId;
+    char *libvirt_xml = NULL;
+    time_t logged = time(NULL);
+    ebs_volume_data *vol_data = NULL;
+    virConnectPtr conn = NULL;
+    virDomainPtr dom = NULL;
+    virDomainBlockJobInfo info = { 0 };
+
+    set_serial_and_bus(volumeId, disk, serial, sizeof(serial), bus, sizeof(bus));
+    if (connect_ebs(disk, serial, bus, nc, instanceId, volumeId, attachmentToken, &libvirt_xml, &vol_data) != EUCA_OK) {
+        LOGERROR("[%s][%s] failed to connect the target volume\n", instanceId, volumeId);
+        EUCA_FREE(vol_data);
+        return (1);
+    }
+
+    if ((conn = lock_hypervisor_conn()) != NULL) {
+        if ((dom = virDomainLookupByName(conn, instanceId)) != NULL) {
+            // the volume is reused as it is, QEMU writes the whole disk to it
+            if (virDomainBlockCopy(dom, disk, libvirt_xml, NULL, 0, VIR_DOMAIN_BLOCK_COPY_REUSE_EXT) == 0) {
+                started = TRUE;
+            } else {
+                LOGERROR("[%s][%s] failed to start copying disk %s to the volume\n", instanceId, volumeId, disk);
+            }
+            virDomainFree(dom);
+        } else {
+            LOGERROR("[%s][%s] cannot find the domain to copy disk %s from\n", instanceId, volumeId, disk);
+        }
+        unlock_hypervisor_conn();
+    } else {
+        LOGERROR("[%s][%s] cannot get connection to hypervisor\n", instanceId, volumeId);
+    }
+
+    while (started && !done) {
+        sleep(CREATEIMAGE_LIVE_POLL_SEC);
+
+        // the hypervisor is only locked while the job is checked, not while it runs
+        if ((conn = lock_hypervisor_conn()) == NULL) {
+            LOGWARN("[%s][%s] cannot get connection to hypervisor, will retry\n", instanceId, volumeId);
+            continue;
+        }
+
+        if ((dom = virDomainLookupByName(conn, instanceId)) == NULL) {
+            LOGERROR("[%s][%s] domain disappeared while copying disk %s\n", instanceId, volumeId, disk);
+            unlock_hypervisor_conn();
+            break;
+        }
+
+        jobrc = virDomainGetBlockJobInfo(dom, disk, &info, 0);
+        if (jobrc != 1) {
+            LOGERROR("[%s][%s] the copy of disk %s stopped before it completed\n", instanceId, volumeId, disk);
+            done = TRUE;
+        } else if (instance->createImageCanceled) {
+            LOGINFO("[%s][%s] cancelling the copy of disk %s\n", instanceId, volumeId, disk);
+            virDomainBlockJobAbort(dom, disk, 0);
+            rc = -1;
+            done = TRUE;
+        } else if ((info.end > 0) && (info.cur == info.end)) {
+            // the mirror is in sync, end it with the guest file systems frozen, if possible
+            if ((frozen = virDomainFSFreeze(dom, NULL, 0, 0)) < 0) {
+                LOGDEBUG("[%s][%s] could not freeze the guest file systems, copying disk %s as is\n", instanceId, volumeId, disk);
+            }
+
+            if (virDomainBlockJobAbort(dom, disk, 0) == 0) {
+                LOGINFO("[%s][%s] copied %llu bytes of disk %s to the volume\n", instanceId, volumeId, info.end, disk);
+                rc = 0;
+            } else {
+                LOGERROR("[%s][%s] failed to end the copy of disk %s\n", instanceId, volumeId, disk);
+            }
+
+            if ((frozen > 0) && (virDomainFSThaw(dom, NULL, 0, 0) < 0)) {
+                LOGERROR("[%s][%s] failed to thaw the guest file systems\n", instanceId, volumeId);
+            }
+            done = TRUE;
+        } else if ((time(NULL) - logged) >= CREATEIMAGE_LIVE_LOG_SEC) {
+            LOGINFO("[%s][%s] copied %llu of %llu bytes of disk %s\n", instanceId, volumeId, info.cur, info.end, disk);
+            logged = time(NULL);
+        }
+
+        virDomainFree(dom);
+        unlock_hypervisor_conn();
+    }
+
+    if (disconnect_ebs(nc, instanceId, volumeId, attachmentToken, vol_data->connect_string) != EUCA_OK) {
+        LOGERROR("[%s][%s] failed to disconnect the target volume\n", instanceId, volumeId);
+    }
+
+    EUCA_FREE(vol_data);
+    EUCA_FREE(libvirt_xml);
+    return (rc);
+}
+
+//!
+//! Defines the thread of a live createImage (see createImage_live_copy()), during which
+//! the instance keeps running.
+//!
+//! @param[in] arg a transparent pointer to the create image parameters
+//!
+//! @return Always return NULL
+//!
+static void *createImage_live_thread(void *arg)
+{
+    int rc = 0;
+    struct createImage_params_t *params = (struct createImage_params_t *)arg;
+    ncInstance *instance = params->instance;
+
+    LOGINFO("[%s] started live createImage of disk %s\n", instance->instanceId, params->diskName);
+    rc = createImage_live_copy(params->nc, instance, params->volumeId, params->remoteDev, params->diskName);
+    if (rc == 0) {
+        cleanup_createImage_task(instance, params, NO_STATE, CREATEIMAGE_SUCCESS);
+        LOGINFO("[%s] finished live createImage for instance\n", instance->instanceId);
+    } else if (rc == -1) {
+        cleanup_createImage_task(instance, params, NO_STATE, CREATEIMAGE_CANCELLED);
+        LOGINFO("[%s] cancelled live createImage for instance\n", instance->instanceId);
+    } else {
+        cleanup_createImage_task(instance, params, NO_STATE, CREATEIMAGE_FAILED);
+        LOGERROR("[%s] failed live createImage for instance\n", instance->instanceId);
+    }
+    unset_corrid(get_corrid());
+    return NULL;
+}
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+
 //!
 //! Handles the image creation request.
 //!
+//! With CREATE_IMAGE_LIVE on KVM, the root disk is copied while the instance keeps running
+//! (see createImage_live_copy()). Otherwise the instance is shut down first.
+//!
 //! @param[in] nc a pointer to the NC state structure
 //! @param[in] pMeta a pointer to the node controller (NC) metadata structure
 //! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
@@ -1706,6 +2044,57 @@ static int doCreateImage(struct nc_state_t *nc, ncMetadata * pMeta, char *instan
     params->volumeId = strdup(volumeId);
     params->remoteDev = strdup(remoteDev);
 
+#if LIBVIR_VERSION_NUMBER >= 1002008
+    if (nc->createimage_live && !strcmp(nc->H->name, "kvm")) {
+        int err = EUCA_OK;
+        char *p = NULL;
+        pthread_t tid = { 0 };
+        pthread_attr_t tattr = { {0} };
+
+        params->nc = nc;
+        sem_p(inst_sem);
+        {
+            if (instance->state != RUNNING) {
+                LOGERROR("[%s][%s] instance must be running for a live createImage\n", instanceId, volumeId);
+                err = EUCA_ERROR;
+            } else if (instance->createImageTaskState == CREATEIMAGE_IN_PROGRESS) {
+                LOGERROR("[%s][%s] a createImage is already in progress for the instance\n", instanceId, volumeId);
+                err = EUCA_ERROR;
+            } else if ((instance->params.root == NULL) || ((params->diskName = strdup(instance->params.root->guestDeviceName)) == NULL)) {
+                LOGERROR("[%s][%s] cannot find the root disk of the instance\n", instanceId, volumeId);
+                err = EUCA_ERROR;
+            } else {
+                // a root partition (e.g., sda1) is part of a disk (sda) and the whole disk is copied
+                for (p = params->diskName + strlen(params->diskName); (p > params->diskName) && isdigit(*(p - 1)); p--)
+                    *(p - 1) = '\0';
+                instance->createImageTime = time(NULL);
+                instance->createImageCanceled = FALSE;
+                change_createImage_state(instance, CREATEIMAGE_IN_PROGRESS);
+                copy_instances();
+            }
+        }
+        sem_v(inst_sem);
+
+        if (err != EUCA_OK) {
+            EUCA_FREE(params->volumeId);
+            EUCA_FREE(params->remoteDev);
+            EUCA_FREE(params->diskName);
+            EUCA_FREE(params);
+            return err;
+        }
+
+        pthread_attr_init(&tattr);
+        pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&tid, &tattr, createImage_live_thread, (void *)params) != 0) {
+            LOGERROR("[%s][%s] failed to start VM createImage thread\n", instanceId, volumeId);
+            return cleanup_createImage_task(instance, params, NO_STATE, CREATEIMAGE_FAILED);
+        }
+
+        set_corrid_pthread(get_corrid() != NULL ? get_corrid()->correlation_id : NULL, tid);
+        return EUCA_OK;
+    }
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+
     // terminate the instance
     sem_p(inst_sem);
     instance->createImageTime = time(NULL);
@@ -2203,9 +2592,15 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
     if (err != 0)
         LOGERROR("failed to update sensor configuration (err=%d)\n", err);
 
-    sem_p(inst_copy_sem);
+    instancesSnapshot *snapshot = acquire_instances_snapshot();
+    if (snapshot == NULL) {
+        *outResourcesLen = 0;
+        *outResources = NULL;
+        return EUCA_OK;                // nothing published yet, so no instances
+    }
+
     if (instIdsLen == 0)               // describe all instances
-        total = total_instances(&global_instances_copy);
+        total = snapshot->instancesLen;
     else
         total = instIdsLen;
 
@@ -2213,7 +2608,7 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
     if (total > 0) {
         rss = EUCA_ZALLOC(total, sizeof(sensorResource *));
         if (rss == NULL) {
-            sem_v(inst_copy_sem);
+            release_instances_snapshot(snapshot);
             return EUCA_MEMORY_ERROR;
         }
     }
@@ -2221,7 +2616,8 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
     int k = 0;
 
     ncInstance *instance;
-    for (int i = 0; (instance = get_instance(&global_instances_copy)) != NULL; i++) {
+    for (int i = 0; i < snapshot->instancesLen; i++) {
+        instance = snapshot->instances[i];
         // only pick ones the user (or admin) is allowed to see
         if (strcmp(pMeta->userId, nc->admin_user_id)
             && strcmp(pMeta->userId, instance->userId))
@@ -2251,7 +2647,7 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
 
     *outResourcesLen = k;
     *outResources = rss;
-    sem_v(inst_copy_sem);
+    release_instances_snapshot(snapshot);
 
     LOGDEBUG("found %d resource(s)\n", k);
     return EUCA_OK;
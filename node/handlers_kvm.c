@@ -110,6 +110,10 @@
 \*----------------------------------------------------------------------------*/
 
 #define HYPERVISOR_URI                        "qemu:///system" /**< Defines the Hypervisor URI to use with KVM */
+#define MIGRATION_PROGRESS_PERIOD_SEC         2    //!< how often, in seconds, the progress of an outgoing migration is checked
+#define CONSOLE_RING_SIZE                     (64 * 1024)   //!< bytes at the end of console.log that are kept, and returned, per instance
+#define CONSOLE_APPEND_SIZE                   4096 //!< most bytes of console.append.log that are returned
+#define CONSOLE_RING_IDLE_SEC                 3600 //!< console rings of instances not polled for that long are dropped
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -133,6 +137,35 @@ typedef struct rebooting_thread_params_t {
     struct nc_state_t nc;
 } rebooting_thread_params;
 
+//! An outgoing migration, shared by migrating_thread() and its progress thread
+typedef struct migrationJob_t {
+    ncInstance *instance;              //!< the instance being migrated
+    virDomainPtr dom;                  //!< its domain on the source
+    boolean postcopy;                  //!< TRUE if the migration may switch to post-copy
+    boolean done;                      //!< set by migrating_thread() once the migration returns
+    pthread_mutex_t mutex;             //!< guards done
+    pthread_cond_t cond;               //!< signaled when done is set
+} migrationJob;
+
+//! The last CONSOLE_RING_SIZE bytes of the console log of an instance, kept by the NC so that
+//! a poll only reads the console output that is new since the previous poll
+typedef struct consoleRing_t {
+    char instanceId[CHAR_BUFFER_SIZE]; //!< the instance (empty if the entry is free)
+    dev_t dev;                         //!< device of the console.log read so far
+    ino_t ino;                         //!< inode of the console.log read so far (0 if none)
+    off_t offset;                      //!< how far console.log has been read
+    char *data;                        //!< the ring itself, CONSOLE_RING_SIZE bytes
+    size_t start;                      //!< index in data of the oldest byte kept
+    size_t len;                        //!< number of bytes kept
+    ino_t append_ino;                  //!< inode of console.append.log (0 if none)
+    off_t append_size;                 //!< size of console.append.log when it was read
+    time_t append_mtime;               //!< modification time of console.append.log when it was read
+    char append[CONSOLE_APPEND_SIZE];  //!< the head of console.append.log
+    size_t append_len;                 //!< number of bytes in append
+    char *encoded;                     //!< base64-encoded output of the last poll, NULL if there is new output
+    time_t used;                       //!< time of the last poll
+} consoleRing;
+
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -148,6 +181,7 @@ extern sem *hyp_sem;
 extern bunchOfInstances *global_instances;
 extern int outgoing_migrations_in_progress;
 extern int incoming_migrations_in_progress;
+extern struct nc_state_t nc_state;
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -161,6 +195,12 @@ extern int incoming_migrations_in_progress;
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static sem *migration_sem = NULL;      //!< limits the number of concurrent outgoing migrations, or NULL for no limit
+static pthread_once_t migration_once = PTHREAD_ONCE_INIT;   //!< creates migration_sem on first use
+
+static consoleRing console_rings[MAXINSTANCES_PER_NC];  //!< console output of the instances being polled
+static pthread_mutex_t console_rings_mutex = PTHREAD_MUTEX_INITIALIZER; //!< protects console_rings
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -171,8 +211,16 @@ static int doInitialize(struct nc_state_t *nc);
 static void *rebooting_thread(void *arg);
 static int doRebootInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *instanceId);
 static int doGetConsoleOutput(struct nc_state_t *nc, ncMetadata * pMeta, char *instanceId, char **consoleOutput);
+static consoleRing *console_ring_get(const char *instanceId);
+static void console_ring_push(consoleRing * ring, const char *buf, size_t size);
+static int console_ring_refresh(struct nc_state_t *nc, consoleRing * ring, const char *instanceId, const char *path);
+static int console_ring_refresh_append(struct nc_state_t *nc, consoleRing * ring, const char *instanceId, const char *path);
 static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials);
 static int generate_migration_keys(char *host, char *credentials, boolean restart, ncInstance * instance);
+static void init_migration_sem(void);
+#if LIBVIR_VERSION_NUMBER >= 1003004
+static void *migration_progress_thread(void *arg);
+#endif /* LIBVIR_VERSION_NUMBER >= 1003004 */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -232,8 +280,6 @@ static int generate_migration_keys(char *host, char *credentials, boolean restar
     char generate_keys[EUCA_MAX_PATH] = "";
     char *euca_base = getenv(EUCALYPTUS_ENV_VAR_NAME);
     char *instanceId = instance ? instance->instanceId : "UNSET";
-    static char *most_recent_credentials = NULL;
-    static char *most_recent_host = NULL;
 
     if (!host || !credentials) {
         LOGERROR("[%s] called with invalid arguments for host and/or credentials: host=%s, creds=%s\n", SP(instanceId), SP(host), (credentials == NULL) ? "UNSET" : "present");
@@ -242,40 +288,22 @@ static int generate_migration_keys(char *host, char *credentials, boolean restar
 
     sem_p(hyp_sem);
 
-    if (most_recent_credentials && most_recent_host && !strcmp(most_recent_credentials, credentials) && !strcmp(most_recent_host, host)) {
+    // keys for the same peer and secret are reused until they expire, see migration_keys_current()
+    if (migration_keys_current(host, credentials)) {
         LOGDEBUG("[%s] request to generate key using same information (host='%s', creds=%s) as previous request, skipping\n", instanceId, host,
                  (credentials == NULL) ? "UNSET" : "present");
         sem_v(hyp_sem);
         return (EUCA_OK);
     }
 
-    if (!most_recent_credentials) {
-        most_recent_credentials = strdup(credentials);
-        LOGDEBUG("[%s] first generation of migration credentials\n", instanceId);
-    }
-
-    if (!most_recent_host) {
-        most_recent_host = strdup(host);
-        LOGDEBUG("[%s] first generation of migration host information: %s\n", instanceId, most_recent_host);
-    }
-    // So, something has changed.
-    if (strcmp(most_recent_credentials, credentials)) {
-        EUCA_FREE(most_recent_credentials);
-        most_recent_credentials = strdup(credentials);
-        LOGDEBUG("[%s] regeneration of migration credentials\n", instanceId);
-    }
-
-    if (strcmp(most_recent_host, host)) {
-        EUCA_FREE(most_recent_host);
-        most_recent_host = strdup(host);
-        LOGDEBUG("[%s] regeneration of migration host information: %s\n", instanceId, most_recent_host);
-    }
     // TO-DO: Add polling around incoming_migrations_in_progress to prevent restarts during migrations?
     snprintf(generate_keys, EUCA_MAX_PATH, EUCALYPTUS_GENERATE_MIGRATION_KEYS, ((euca_base != NULL) ? euca_base : ""));
     snprintf(euca_rootwrap, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, ((euca_base != NULL) ? euca_base : ""));
 
     LOGDEBUG("[%s] executing migration key-generator: '%s %s %s %s %s'\n", instanceId, euca_rootwrap, generate_keys, host, credentials, ((restart == TRUE) ? "restart" : ""));
     rc = euca_execlp(NULL, euca_rootwrap, generate_keys, host, credentials, ((restart == TRUE) ? "restart" : ""), NULL);
+    if (!rc)
+        migration_keys_generated(host, credentials, restart);
 
     sem_v(hyp_sem);
 
@@ -348,7 +376,7 @@ static void *rebooting_thread(void *arg)
 
     LOGDEBUG("[%s] spawning rebooting thread\n", instance->instanceId);
 
-    if ((conn = lock_hypervisor_conn()) == NULL) {
+    if ((conn = lock_hypervisor_query_conn()) == NULL) {
         LOGERROR("[%s] cannot connect to hypervisor to restart instance, giving up\n", instance->instanceId);
         EUCA_FREE(params);
         return NULL;
@@ -356,7 +384,7 @@ static void *rebooting_thread(void *arg)
     dom = virDomainLookupByName(conn, instance->instanceId);
     if (dom == NULL) {
         LOGERROR("[%s] cannot locate instance to reboot, giving up\n", instance->instanceId);
-        unlock_hypervisor_conn();
+        unlock_hypervisor_query_conn(conn);
         EUCA_FREE(params);
         return NULL;
     }
@@ -365,12 +393,12 @@ static void *rebooting_thread(void *arg)
     if (xml == NULL) {
         LOGERROR("[%s] cannot obtain metadata for instance to reboot, giving up\n", instance->instanceId);
         virDomainFree(dom);            // release libvirt resource
-        unlock_hypervisor_conn();
+        unlock_hypervisor_query_conn(conn);
         EUCA_FREE(params);
         return NULL;
     }
     virDomainFree(dom);                // release libvirt resource
-    unlock_hypervisor_conn();
+    unlock_hypervisor_query_conn(conn);
 
     // try shutdown first, then kill it if uncooperative
     if (shutdown_then_destroy_domain(instance->instanceId, TRUE) != EUCA_OK) {
@@ -473,9 +501,209 @@ static int doRebootInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *ins
     return (EUCA_OK);
 }
 
+//!
+//! Finds the console ring of an instance, setting up a new one if the instance has none.
+//! When all the entries are in use, the one polled the longest time ago is reused. Rings
+//! which were not polled for CONSOLE_RING_IDLE_SEC are dropped along the way.
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+//! @return a pointer to the ring or NULL if no memory could be allocated for it
+//!
+//! @pre The caller must hold console_rings_mutex.
+//!
+static consoleRing *console_ring_get(const char *instanceId)
+{
+    int i = 0;
+    int slot = -1;
+    time_t now = time(NULL);
+    consoleRing *ring = NULL;
+
+    for (i = 0; i < MAXINSTANCES_PER_NC; i++) {
+        ring = &console_rings[i];
+        if ((ring->instanceId[0] != '\0') && !strcmp(ring->instanceId, instanceId)) {
+            ring->used = now;
+            return (ring);
+        }
+
+        if ((ring->instanceId[0] != '\0') && ((now - ring->used) > CONSOLE_RING_IDLE_SEC)) {
+            LOGDEBUG("[%s] dropping console output not polled for %d seconds\n", ring->instanceId, CONSOLE_RING_IDLE_SEC);
+            EUCA_FREE(ring->data);
+            EUCA_FREE(ring->encoded);
+            bzero(ring, sizeof(consoleRing));
+        }
+
+        if ((slot < 0) || ((console_rings[slot].instanceId[0] != '\0') && ((ring->instanceId[0] == '\0') || (ring->used < console_rings[slot].used))))
+            slot = i;
+    }
+
+    ring = &console_rings[slot];
+    EUCA_FREE(ring->data);
+    EUCA_FREE(ring->encoded);
+    bzero(ring, sizeof(consoleRing));
+    if ((ring->data = EUCA_ALLOC(CONSOLE_RING_SIZE, sizeof(char))) == NULL)
+        return (NULL);
+
+    euca_strncpy(ring->instanceId, instanceId, sizeof(ring->instanceId));
+    ring->used = now;
+    return (ring);
+}
+
+//!
+//! Appends console output to a ring, dropping the oldest bytes when it is full
+//!
+//! @param[in] ring a pointer to the console ring
+//! @param[in] buf the new console output
+//! @param[in] size the number of bytes in buf
+//!
+static void console_ring_push(consoleRing * ring, const char *buf, size_t size)
+{
+    size_t end = 0;
+    size_t first = 0;
+
+    if (size >= CONSOLE_RING_SIZE) {
+        buf += (size - CONSOLE_RING_SIZE);
+        size = CONSOLE_RING_SIZE;
+        ring->start = 0;
+        ring->len = 0;
+    }
+
+    end = (ring->start + ring->len) % CONSOLE_RING_SIZE;
+    first = MIN(size, (CONSOLE_RING_SIZE - end));
+    memcpy(ring->data + end, buf, first);
+    memcpy(ring->data, buf + first, (size - first));
+
+    ring->len += size;
+    if (ring->len > CONSOLE_RING_SIZE) {
+        ring->start = (ring->start + ring->len - CONSOLE_RING_SIZE) % CONSOLE_RING_SIZE;
+        ring->len = CONSOLE_RING_SIZE;
+    }
+}
+
+//!
+//! Brings a console ring up to date with console.log, reading only what was written to it
+//! since the last poll (and no more than CONSOLE_RING_SIZE bytes). The file is only handed
+//! over to the admin user, which takes two rootwrap'ed commands, when a new file shows up.
+//!
+//! @param[in] nc a pointer to the NC state structure
+//! @param[in] ring a pointer to the console ring of the instance
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//! @param[in] path the path of console.log
+//!
+//! @return EUCA_OK on success (including when there is no console.log yet) or EUCA_ERROR on failure
+//!
+//! @pre The caller must hold console_rings_mutex.
+//!
+static int console_ring_refresh(struct nc_state_t *nc, consoleRing * ring, const char *instanceId, const char *path)
+{
+    int fd = -1;
+    ssize_t rbytes = 0;
+    char chunk[16384] = "";
+    struct stat statbuf = { 0 };
+
+    if (stat(path, &statbuf) < 0) {
+        LOGERROR("[%s] cannot stat console_output file '%s'\n", instanceId, path);
+        return (EUCA_OK);
+    }
+
+    if ((ring->ino != statbuf.st_ino) || (ring->dev != statbuf.st_dev) || (statbuf.st_size < ring->offset)) {
+        // a new (or truncated) console log, start over
+        if (diskutil_ch(path, nc->admin_user_id, nc->admin_user_id, 0) != EUCA_OK) {
+            LOGERROR("[%s] failed to change ownership of %s\n", instanceId, path);
+            return (EUCA_ERROR);
+        }
+        ring->dev = statbuf.st_dev;
+        ring->ino = statbuf.st_ino;
+        ring->offset = 0;
+        ring->start = 0;
+        ring->len = 0;
+        EUCA_FREE(ring->encoded);
+    }
+
+    if (statbuf.st_size == ring->offset)
+        return (EUCA_OK);
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        LOGERROR("[%s] cannot open '%s' read-only\n", instanceId, path);
+        return (EUCA_OK);
+    }
+
+    if ((statbuf.st_size - ring->offset) > CONSOLE_RING_SIZE) {
+        // only the last CONSOLE_RING_SIZE bytes would be kept anyway
+        ring->offset = statbuf.st_size - CONSOLE_RING_SIZE;
+        ring->start = 0;
+        ring->len = 0;
+    }
+
+    while ((rbytes = pread(fd, chunk, sizeof(chunk), ring->offset)) > 0) {
+        console_ring_push(ring, chunk, rbytes);
+        ring->offset += rbytes;
+    }
+    close(fd);
+
+    EUCA_FREE(ring->encoded);
+    return (EUCA_OK);
+}
+
+//!
+//! Brings the copy of the head of console.append.log kept in a console ring up to date,
+//! reading the file again only if it changed since the last poll
+//!
+//! @param[in] nc a pointer to the NC state structure
+//! @param[in] ring a pointer to the console ring of the instance
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//! @param[in] path the path of console.append.log
+//!
+//! @return EUCA_OK on success (including when there is no console.append.log) or EUCA_ERROR on failure
+//!
+//! @pre The caller must hold console_rings_mutex.
+//!
+static int console_ring_refresh_append(struct nc_state_t *nc, consoleRing * ring, const char *instanceId, const char *path)
+{
+    int fd = -1;
+    ssize_t rbytes = 0;
+    struct stat statbuf = { 0 };
+
+    if (stat(path, &statbuf) < 0) {
+        if (ring->append_ino != 0) {
+            ring->append_ino = 0;
+            ring->append_len = 0;
+            EUCA_FREE(ring->encoded);
+        }
+        return (EUCA_OK);
+    }
+
+    if ((ring->append_ino == statbuf.st_ino) && (ring->append_size == statbuf.st_size) && (ring->append_mtime == statbuf.st_mtime))
+        return (EUCA_OK);
+
+    if (ring->append_ino != statbuf.st_ino) {
+        if (diskutil_ch(path, nc->admin_user_id, nc->admin_user_id, 0) != EUCA_OK) {
+            LOGERROR("[%s] failed to change ownership of %s\n", instanceId, path);
+            return (EUCA_ERROR);
+        }
+    }
+
+    ring->append_len = 0;
+    if ((fd = open(path, O_RDONLY)) >= 0) {
+        if ((rbytes = read(fd, ring->append, (CONSOLE_APPEND_SIZE - 1))) > 0)
+            ring->append_len = rbytes;
+        close(fd);
+    }
+
+    ring->append_ino = statbuf.st_ino;
+    ring->append_size = statbuf.st_size;
+    ring->append_mtime = statbuf.st_mtime;
+    EUCA_FREE(ring->encoded);
+    return (EUCA_OK);
+}
+
 //!
 //! Handles the console output retrieval request.
 //!
+//! The NC keeps the last CONSOLE_RING_SIZE bytes of the console log of each instance that
+//! is polled, so a poll only reads from disk the output that is new since the last poll,
+//! and only encodes the output again if there is any.
+//!
 //! @param[in]  nc a pointer to the NC state structure to initialize
 //! @param[in]  pMeta a pointer to the node controller (NC) metadata structure
 //! @param[in]  instanceId the instance identifier string (i-XXXXXXXX)
@@ -485,27 +713,22 @@ static int doRebootInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *ins
 //!
 static int doGetConsoleOutput(struct nc_state_t *nc, ncMetadata * pMeta, char *instanceId, char **consoleOutput)
 {
-    int rc = 0;
-    int fd = 0;
     int ret = EUCA_OK;
-    int readsize = 0;
+    size_t first = 0;
     char *console_output = NULL;
-    char *console_append = NULL;
-    char *console_main = NULL;
+    char append_file[EUCA_MAX_PATH] = "";
     char console_file[EUCA_MAX_PATH] = "";
-    char userId[48] = "";
     ncInstance *instance = NULL;
-    struct stat statbuf = { 0 };
+    consoleRing *ring = NULL;
 
     *consoleOutput = NULL;
-    readsize = 64 * 1024;
 
     // find the instance record
     sem_p(inst_sem);
     {
         if ((instance = find_instance(&global_instances, instanceId)) != NULL) {
-            snprintf(console_file, 1024, "%s/console.append.log", instance->instancePath);
-            snprintf(userId, 48, "%s", instance->userId);
+            snprintf(append_file, sizeof(append_file), "%s/console.append.log", instance->instancePath);
+            snprintf(console_file, sizeof(console_file), "%s/console.log", instance->instancePath);
         }
     }
     sem_v(inst_sem);
@@ -514,81 +737,128 @@ static int doGetConsoleOutput(struct nc_state_t *nc, ncMetadata * pMeta, char *i
         LOGERROR("[%s] cannot locate instance\n", instanceId);
         return (EUCA_NOT_FOUND_ERROR);
     }
-    // read from console.append.log if it exists into dynamically allocated 4K console_append buffer
-    if ((rc = stat(console_file, &statbuf)) >= 0) {
-        if (diskutil_ch(console_file, nc->admin_user_id, nc->admin_user_id, 0) != EUCA_OK) {
-            LOGERROR("[%s] failed to change ownership of %s\n", instanceId, console_file);
-            return (EUCA_ERROR);
-        }
 
-        if ((fd = open(console_file, O_RDONLY)) >= 0) {
-            if ((console_append = EUCA_ZALLOC(4096, sizeof(char))) != NULL) {
-                rc = read(fd, console_append, (4096) - 1);
+    pthread_mutex_lock(&console_rings_mutex);
+    {
+        if ((ring = console_ring_get(instanceId)) == NULL) {
+            LOGERROR("[%s] out of memory for the console output\n", instanceId);
+            ret = EUCA_ERROR;
+        } else if ((console_ring_refresh_append(nc, ring, instanceId, append_file) != EUCA_OK) || (console_ring_refresh(nc, ring, instanceId, console_file) != EUCA_OK)) {
+            ret = EUCA_ERROR;
+        } else if (ring->encoded == NULL) {
+            // concatenate the head of console.append.log with the console ring and base64-encode this
+            if ((console_output = EUCA_ALLOC((ring->append_len + ring->len + 1), sizeof(char))) != NULL) {
+                memcpy(console_output, ring->append, ring->append_len);
+                first = MIN(ring->len, (CONSOLE_RING_SIZE - ring->start));
+                memcpy(console_output + ring->append_len, ring->data + ring->start, first);
+                memcpy(console_output + ring->append_len + first, ring->data, (ring->len - first));
+                ring->encoded = base64_enc((unsigned char *)console_output, (ring->append_len + ring->len));
+                EUCA_FREE(console_output);
             }
-            close(fd);
         }
-    }
 
-    sem_p(inst_sem);
-    {
-        snprintf(console_file, EUCA_MAX_PATH, "%s/console.log", instance->instancePath);
+        if ((ret == EUCA_OK) && ((ring->encoded == NULL) || ((*consoleOutput = strdup(ring->encoded)) == NULL)))
+            ret = EUCA_ERROR;
     }
-    sem_v(inst_sem);
+    pthread_mutex_unlock(&console_rings_mutex);
 
-    // read the last 64K from console.log or the whole file, if smaller, into dynamically allocated 64K console_main buffer
-    if ((rc = stat(console_file, &statbuf)) >= 0) {
-        if (diskutil_ch(console_file, nc->admin_user_id, nc->admin_user_id, 0) != EUCA_OK) {
-            LOGERROR("[%s] failed to change ownership of %s\n", instanceId, console_file);
-            EUCA_FREE(console_append);
-            return (EUCA_ERROR);
-        }
-
-        if ((fd = open(console_file, O_RDONLY)) >= 0) {
-            if ((rc = lseek(fd, (off_t) (-1 * readsize), SEEK_END)) < 0) {
-                if ((rc = lseek(fd, (off_t) 0, SEEK_SET)) < 0) {
-                    LOGERROR("[%s] cannot seek to beginning of file\n", instanceId);
-                    if (console_append)
-                        EUCA_FREE(console_append);
-                    close(fd);
-                    return (EUCA_ERROR);
-                }
-            }
+    return (ret);
+}
 
-            if ((console_main = EUCA_ZALLOC(readsize, sizeof(char))) != NULL) {
-                rc = read(fd, console_main, (readsize) - 1);
-            }
-            close(fd);
-        } else {
-            LOGERROR("[%s] cannot open '%s' read-only\n", instanceId, console_file);
-        }
-    } else {
-        LOGERROR("[%s] cannot stat console_output file '%s'\n", instanceId, console_file);
+//!
+//! Creates the semaphore that limits the number of concurrent outgoing migrations
+//!
+static void init_migration_sem(void)
+{
+    if (nc_state.migration_max_outgoing > 0) {
+        if ((migration_sem = sem_alloc(nc_state.migration_max_outgoing, IPC_MUTEX_SEMAPHORE)) == NULL)
+            LOGERROR("failed to allocate the migration semaphore, outgoing migrations will not be limited\n");
     }
+}
 
-    // concatenate console_append with console_main, base64-encode this, and put into dynamically allocated buffer consoleOutput
-    ret = EUCA_ERROR;
-    if ((console_output = EUCA_ZALLOC((readsize) + 4096, sizeof(char))) != NULL) {
-        if (console_append) {
-            strncat(console_output, console_append, 4096);
-        }
+#if LIBVIR_VERSION_NUMBER >= 1003004
+//!
+//! Records the progress of an outgoing migration in the instance struct every few seconds and,
+//! if configured, switches the migration to post-copy once it has run for too long.
+//!
+//! @param[in] arg a transparent pointer to the migration job (migrationJob)
+//!
+//! @return Always return NULL
+//!
+static void *migration_progress_thread(void *arg)
+{
+    int type = 0;
+    int nparams = 0;
+    unsigned long long total = 0;
+    unsigned long long processed = 0;
+    unsigned long long remaining = 0;
+    unsigned long long dirty_rate = 0;
+    unsigned long long page_size = 0;
+    time_t started = time(NULL);
+    struct timespec deadline = { 0 };
+    virTypedParameterPtr params = NULL;
+    migrationJob *job = ((migrationJob *) arg);
+    ncInstance *instance = job->instance;
+
+    pthread_mutex_lock(&job->mutex);
+    while (!job->done) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += MIGRATION_PROGRESS_PERIOD_SEC;
+        pthread_cond_timedwait(&job->cond, &job->mutex, &deadline);
+        if (job->done)
+            break;
+        pthread_mutex_unlock(&job->mutex);
+
+        if ((virDomainGetJobStats(job->dom, &type, &params, &nparams, 0) == 0) && (type != VIR_DOMAIN_JOB_NONE)) {
+            total = processed = remaining = dirty_rate = 0;
+            page_size = getpagesize();
+            virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_TOTAL, &total);
+            virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_PROCESSED, &processed);
+            virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_DATA_REMAINING, &remaining);
+            virTypedParamsGetULLong(params, nparams, VIR_DOMAIN_JOB_MEMORY_DIRTY_RATE, &dirty_rate);    // in pages per second
 
-        if (console_main) {
-            strncat(console_output, console_main, readsize);
-        }
+            sem_p(inst_sem);
+            instance->migrationProgress = ((total > 0) ? ((int)((processed * 100) / total)) : 0);
+            instance->migrationRemainingBytes = remaining;
+            instance->migrationDirtyRate = (dirty_rate * page_size);
+            copy_instances();
+            sem_v(inst_sem);
 
-        *consoleOutput = base64_enc((unsigned char *)console_output, strlen(console_output));
-        ret = EUCA_OK;
+            LOGDEBUG("[%s] migration %d%% done, %lld MB left, guest dirtying %lld MB/s\n", instance->instanceId, instance->migrationProgress,
+                     (long long)(remaining / MEGABYTE), (long long)((dirty_rate * page_size) / MEGABYTE));
+        }
+        virTypedParamsFree(params, nparams);
+        params = NULL;
+        nparams = 0;
+
+        if (job->postcopy && ((time(NULL) - started) >= nc_state.migration_postcopy_after_sec)) {
+            job->postcopy = FALSE;     // one attempt is enough: it fails only if the migration is past the point of switching
+            if (virDomainMigrateStartPostCopy(job->dom, 0) == 0) {
+                LOGINFO("[%s] migration switched to post-copy after %d seconds\n", instance->instanceId, (int)(time(NULL) - started));
+                sem_p(inst_sem);
+                instance->migrationPostCopy = TRUE;
+                copy_instances();
+                sem_v(inst_sem);
+            } else {
+                LOGWARN("[%s] failed to switch migration to post-copy\n", instance->instanceId);
+            }
+        }
+        pthread_mutex_lock(&job->mutex);
     }
-
-    EUCA_FREE(console_append);
-    EUCA_FREE(console_main);
-    EUCA_FREE(console_output);
-    return (ret);
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
 }
+#endif /* LIBVIR_VERSION_NUMBER >= 1003004 */
 
 //!
 //! Defines the thread that does the actual migration of an instance off the source.
 //!
+//! The migration uses a connection of its own rather than the one serialized by hyp_sem, so
+//! that it neither blocks the other hypervisor operations of the NC nor other migrations, of
+//! which up to NC_MIGRATION_MAX_OUTGOING run at once. With libvirt 1.3.4 or later, the
+//! bandwidth cap, auto-converge, compression and post-copy settings apply, and the progress
+//! of the migration is recorded in the instance struct.
+//!
 //! @param[in] arg a transparent pointer to the argument passed to this thread handler
 //!
 //! @return Always return NULL
@@ -599,10 +869,26 @@ static void *migrating_thread(void *arg)
     virDomainPtr dom = NULL;
     virConnectPtr conn = NULL;
     int migration_error = 0;
+    boolean have_slot = FALSE;
 
     LOGTRACE("invoked for %s\n", instance->instanceId);
 
-    if ((conn = lock_hypervisor_conn()) == NULL) {
+    pthread_once(&migration_once, init_migration_sem);
+    if (migration_sem) {
+        LOGDEBUG("[%s] waiting for one of %d outgoing migration slots\n", instance->instanceId, nc_state.migration_max_outgoing);
+        sem_p(migration_sem);
+        have_slot = TRUE;
+    }
+
+    sem_p(inst_sem);
+    instance->migrationProgress = 0;
+    instance->migrationRemainingBytes = 0;
+    instance->migrationDirtyRate = 0;
+    instance->migrationPostCopy = FALSE;
+    copy_instances();
+    sem_v(inst_sem);
+
+    if ((conn = virConnectOpen(nc_state.uri)) == NULL) {
         LOGERROR("[%s] cannot migrate instance %s (failed to connect to hypervisor), giving up and rolling back.\n", instance->instanceId, instance->instanceId);
         migration_error++;
         goto out;
@@ -637,14 +923,59 @@ static void *migrating_thread(void *arg)
     }
 
     LOGINFO("[%s] migrating instance\n", instance->instanceId);
+#if LIBVIR_VERSION_NUMBER >= 1003004
+    int nparams = 0;
+    int maxparams = 0;
+    unsigned int flags = VIR_MIGRATE_LIVE | VIR_MIGRATE_NON_SHARED_DISK;
+    char *tok = NULL;
+    char *saveptr = NULL;
+    char compression[SMALL_CHAR_BUFFER_SIZE] = "";
+    pthread_t progress_tcb = { 0 };
+    boolean have_progress = FALSE;
+    virTypedParameterPtr params = NULL;
+    migrationJob job = { instance, dom, FALSE, FALSE, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+    if (nc_state.migration_bandwidth_mbs > 0)
+        virTypedParamsAddULLong(&params, &nparams, &maxparams, VIR_MIGRATE_PARAM_BANDWIDTH, nc_state.migration_bandwidth_mbs);
+    if (nc_state.migration_auto_converge)
+        flags |= VIR_MIGRATE_AUTO_CONVERGE;
+    euca_strncpy(compression, nc_state.migration_compression, sizeof(compression));
+    for (tok = strtok_r(compression, ", ", &saveptr); tok; tok = strtok_r(NULL, ", ", &saveptr)) {
+        virTypedParamsAddString(&params, &nparams, &maxparams, VIR_MIGRATE_PARAM_COMPRESSION, tok);
+        flags |= VIR_MIGRATE_COMPRESSED;
+    }
+    if (nc_state.migration_postcopy_after_sec > 0) {
+        flags |= VIR_MIGRATE_POSTCOPY;
+        job.postcopy = TRUE;
+    }
+
+    if (pthread_create(&progress_tcb, NULL, migration_progress_thread, (void *)&job)) {
+        LOGWARN("[%s] failed to spawn a migration progress thread, migrating without progress reports\n", instance->instanceId);
+    } else {
+        have_progress = TRUE;
+    }
+
+    virDomain *ddom = virDomainMigrate3(dom, dconn, params, nparams, flags);
+
+    if (have_progress) {
+        pthread_mutex_lock(&job.mutex);
+        job.done = TRUE;
+        pthread_cond_signal(&job.cond);
+        pthread_mutex_unlock(&job.mutex);
+        pthread_join(progress_tcb, NULL);
+    }
+    virTypedParamsFree(params, nparams);
+#else /* LIBVIR_VERSION_NUMBER >= 1003004 */
     virDomain *ddom = virDomainMigrate(dom,
                                        dconn,
                                        VIR_MIGRATE_LIVE | VIR_MIGRATE_NON_SHARED_DISK,
                                        NULL,    // new name on destination (optional)
                                        NULL,    // destination URI as seen from source (optional)
-                                       0L); // bandwidth limitation (0 => unlimited)
+                                       nc_state.migration_bandwidth_mbs);   // bandwidth limitation (0 => unlimited)
+#endif /* LIBVIR_VERSION_NUMBER >= 1003004 */
     if (ddom == NULL) {
         LOGERROR("[%s] cannot migrate instance, giving up and rolling back.\n", instance->instanceId);
+        virConnectClose(dconn);
         migration_error++;
         goto out;
     } else {
@@ -658,7 +989,10 @@ out:
         virDomainFree(dom);
 
     if (conn != NULL)
-        unlock_hypervisor_conn();
+        virConnectClose(conn);
+
+    if (have_slot)
+        sem_v(migration_sem);
 
     sem_p(inst_sem);
     LOGDEBUG("%d outgoing migrations still active\n", --outgoing_migrations_in_progress);
@@ -669,6 +1003,8 @@ out:
         // both the source and destination nodes to report the same instance
         // as Extant/NOT_MIGRATING, which is confusing!
         instance->migration_state = MIGRATION_CLEANING;
+        instance->migrationProgress = 100;
+        instance->migrationRemainingBytes = 0;
         save_instance_struct(instance);
         copy_instances();
     }
@@ -890,39 +1226,23 @@ static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInsta
             set_instance_params(instance);
 
             if ((error = create_instance_backing(instance, TRUE))   // create files that back the disks
-                || (error = gen_instance_xml(instance)) // create euca-specific instance XML file
+                || (error = sync_instance_struct(instance)) // create euca-specific instance XML file
                 || (error = gen_libvirt_instance_xml(instance))) {  // transform euca-specific XML into libvirt XML
                 LOGERROR("[%s] failed to prepare images for migrating instance (error=%d)\n", instance->instanceId, error);
                 goto failed_dest;
             }
-            // attach any volumes
+            // connect any volumes, all at once
+            int volumesLen = 0;
+            ncVolume *volumes[EUCA_MAX_VOLUMES] = { NULL };
             for (int v = 0; v < EUCA_MAX_VOLUMES; v++) {
                 ncVolume *volume = &instance->volumes[v];
                 if (strcmp(volume->stateName, VOL_STATE_ATTACHED) && strcmp(volume->stateName, VOL_STATE_ATTACHING))
                     continue;          // skip the entry unless attached or attaching
                 LOGDEBUG("[%s] volumes [%d] = '%s'\n", instance->instanceId, v, volume->stateName);
-
-                ebs_volume_data *vol_data = NULL;
-                char *libvirt_xml = NULL;
-                char serial[128];
-                char bus[16];
-                set_serial_and_bus(volume->volumeId, volume->devName, serial, sizeof(serial), bus, sizeof(bus));
-
-                if ((ret = connect_ebs(volume->devName, serial, bus, nc, instance->instanceId, volume->volumeId, volume->attachmentToken, &libvirt_xml, &vol_data)) != EUCA_OK) {
-                    goto unroll;
-                }
-                // update the volume struct with connection string obtained from SC
-                euca_strncpy(volume->connectionString, vol_data->connect_string, sizeof(volume->connectionString));
-
-                continue;
-unroll:
+                volumes[volumesLen++] = volume;
+            }
+            if (connect_ebs_volumes(nc, instance->instanceId, volumes, volumesLen) != EUCA_OK) {
                 ret = EUCA_ERROR;
-
-                // @TODO: unroll all previous ones
-                //  for (int uv = v - 1; uv >= 0; uv--) {
-                //    disconnect_ebs(nc, instance->instanceId, volume->volumeId, )
-                //  }
-
                 goto failed_dest;
             }
 
@@ -985,8 +1305,8 @@ failed_dest:
                 }
                 // TO-DO: Add belt and suspenders?
                 if (!incoming_migrations_pending) {
-                    LOGINFO("[%s] no remaining incoming or pending migrations -- deauthorizing all migration client keys\n", instance->instanceId);
-                    authorize_migration_keys("-D -r", NULL, NULL, NULL, FALSE);
+                    LOGINFO("[%s] no remaining incoming or pending migrations\n", instance->instanceId);
+                    deauthorize_migration_keys();
                 }
             }
             sem_v(inst_sem);
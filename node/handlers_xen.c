@@ -335,7 +335,6 @@ static int doGetConsoleOutput(struct nc_state_t *nc, ncMetadata * pMeta, char *i
     char *console_output = NULL;
     char *console_append = NULL;
     char *console_main = NULL;
-    char *tmp = NULL;
     char console_file[EUCA_MAX_PATH] = "";
     char dest_file[EUCA_MAX_PATH] = "";
     char userId[48] = "";
@@ -343,6 +342,7 @@ static int doGetConsoleOutput(struct nc_state_t *nc, ncMetadata * pMeta, char *i
     ncInstance *instance = NULL;
     struct stat statbuf = { 0 };
     struct timeval tv = { 0 };
+    file_view tail = { 0 };
 
     *consoleOutput = NULL;
 
@@ -386,9 +386,9 @@ static int doGetConsoleOutput(struct nc_state_t *nc, ncMetadata * pMeta, char *i
             // was able to copy xen guest console file, read it
             LOGDEBUG("[%s] executing '%s chown %s:%s %s'\n", instanceId, nc->rootwrap_cmd_path, nc->admin_user_id, nc->admin_user_id, dest_file);
             if ((rc = euca_execlp(NULL, nc->rootwrap_cmd_path, "chown", nc->admin_user_id, nc->admin_user_id, dest_file, NULL)) == EUCA_OK) {
-                if ((tmp = file2str_seek(dest_file, bufsize, 1)) != NULL) {
-                    snprintf(console_main, bufsize, "%s", tmp);
-                    EUCA_FREE(tmp);
+                if (file_view_tail(dest_file, (bufsize - 1), &tail) == EUCA_OK) {
+                    memcpy(console_main, tail.data, tail.len);
+                    file_view_close(&tail);
                 } else {
                     snprintf(console_main, bufsize, "NOT SUPPORTED");
                 }
@@ -81,9 +81,15 @@
 #include <string.h>
 #include <time.h>
 #include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>                  // WEXITSTATUS on Lucid
+#include <sys/socket.h>
+#include <sys/inotify.h>
 
 #include <eucalyptus.h>
 #include <misc.h>
@@ -98,6 +104,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define MAX_HOOKS                                 32    //!< most hooks in the hooks directory that are run
+#define HOOK_DAEMON_SUFFIX                 ".daemon"    //!< name suffix of the hooks that are run as persistent daemons
+#define HOOK_DAEMON_TIMEOUT_SEC                   60    //!< how long a hook daemon has to answer an event
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -116,6 +126,14 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A hook found in the hooks directory
+typedef struct hook_t {
+    char path[EUCA_MAX_PATH];          //!< path of the hook executable
+    boolean daemon;                    //!< TRUE if the hook is run as a persistent daemon
+    pid_t pid;                         //!< process of the running daemon, 0 if it is not running
+    int sock;                          //!< our end of the socket connected to the daemon, -1 if it is not running
+} hook;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -144,12 +162,25 @@ static boolean initialized = FALSE;    //!< To check wether or not the hooks wer
 static char euca_path[EUCA_MAX_PATH] = "";  //!< eucalyptus path
 static char hooks_path[EUCA_MAX_PATH] = ""; //!< hook path
 
+static hook hooks[MAX_HOOKS];          //!< the hooks found in hooks_path when it was last scanned
+static int hooks_len = 0;              //!< number of entries in hooks
+static boolean hooks_dir_ok = FALSE;   //!< set if hooks_path could be scanned the last time
+static int hooks_inotify_fd = -1;      //!< inotify descriptor watching hooks_path, -1 if the directory must be scanned on every event
+static pthread_rwlock_t hooks_lock = PTHREAD_RWLOCK_INITIALIZER;    //!< held for writing while hooks is scanned
+static pthread_mutex_t hooks_daemon_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< serializes the events sent to hook daemons
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void scan_hooks(void);
+static void refresh_hooks(void);
+static void stop_hook_daemon(hook * h);
+static int start_hook_daemon(hook * h);
+static int call_hook_daemon(hook * h, const char *event_name, const char *param1);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -163,7 +194,9 @@ static char hooks_path[EUCA_MAX_PATH] = ""; //!< hook path
 \*----------------------------------------------------------------------------*/
 
 //!
-//! Validate and initialize the Eucalyptus and hook directories to use.
+//! Validate and initialize the Eucalyptus and hook directories to use. The list of hooks is
+//! read once here and then kept up to date through inotify, so that events do not have to
+//! scan the hooks directory (and cost next to nothing when there are no hooks).
 //!
 //! @param[in] euca_dir a string containing the Eucalyptus directory to use
 //! @param[in] hooks_dir a string containing the hook directory to use
@@ -184,14 +217,284 @@ int init_hooks(const char *euca_dir, const char *hooks_dir)
     if (check_directory(hooks_path))
         return (EUCA_ERROR);
 
-    LOGINFO("using hooks directory %s\n", hooks_path);
+    pthread_rwlock_wrlock(&hooks_lock);
+    {
+        if (hooks_inotify_fd >= 0)
+            close(hooks_inotify_fd);
+
+        if ((hooks_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+            if (inotify_add_watch(hooks_inotify_fd, hooks_path, (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)) < 0) {
+                close(hooks_inotify_fd);
+                hooks_inotify_fd = -1;
+            }
+        }
+        if (hooks_inotify_fd < 0)
+            LOGWARN("cannot watch hooks directory %s, it will be scanned on every event\n", hooks_path);
+
+        scan_hooks();
+    }
+    pthread_rwlock_unlock(&hooks_lock);
+
+    LOGINFO("using hooks directory %s (%d hooks)\n", hooks_path, hooks_len);
     initialized = TRUE;
     return (EUCA_OK);
 }
 
+//!
+//! Reads the list of hooks from the hooks directory: the executable files and symlinks in
+//! it, in directory order. Daemons of the hooks that are still there are kept running and
+//! the others are stopped.
+//!
+//! @pre The caller must hold hooks_lock for writing.
+//!
+static void scan_hooks(void)
+{
+    int i = 0;
+    int j = 0;
+    int len = 0;
+    DIR *dir = NULL;
+    char *entry_name = NULL;
+    hook found[MAX_HOOKS] = { {{0}} };
+    struct stat sb = { 0 };
+    struct dirent *dir_entry = NULL;
+
+    if ((dir = opendir(hooks_path)) != NULL) {
+        while (((dir_entry = readdir(dir)) != NULL) && (len < MAX_HOOKS)) {
+            entry_name = dir_entry->d_name;
+
+            if (!strcmp(".", entry_name) || !strcmp("..", entry_name))
+                continue;              // ignore known unrelated files
+
+            // get the path of the directory item
+            snprintf(found[len].path, sizeof(found[len].path), "%s/%s", hooks_path, entry_name);
+            if (stat(found[len].path, &sb) == -1)
+                continue;              // ignore access errors
+
+            // run the hook if...
+            if ((S_ISLNK(sb.st_mode) || S_ISREG(sb.st_mode))    // looks like a file or symlink
+                && (sb.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {  // is executable
+                found[len].daemon = ((strlen(entry_name) > strlen(HOOK_DAEMON_SUFFIX))
+                                     && !strcmp(entry_name + strlen(entry_name) - strlen(HOOK_DAEMON_SUFFIX), HOOK_DAEMON_SUFFIX));
+                found[len].pid = 0;
+                found[len].sock = -1;
+                len++;
+            }
+        }
+        if (dir_entry != NULL)
+            LOGWARN("only the first %d hooks in %s are used\n", MAX_HOOKS, hooks_path);
+        closedir(dir);
+    }
+    hooks_dir_ok = (dir != NULL);
+
+    // hand running daemons over to the new list
+    for (i = 0; i < hooks_len; i++) {
+        for (j = 0; (j < len) && (hooks[i].pid > 0); j++) {
+            if (found[j].daemon && !strcmp(found[j].path, hooks[i].path)) {
+                found[j].pid = hooks[i].pid;
+                found[j].sock = hooks[i].sock;
+                hooks[i].pid = 0;
+                hooks[i].sock = -1;
+            }
+        }
+        stop_hook_daemon(&hooks[i]);
+    }
+
+    memcpy(hooks, found, sizeof(hook) * len);
+    hooks_len = len;
+}
+
+//!
+//! Scans the hooks directory again if it changed since it was last scanned, or on every
+//! call if the directory cannot be watched.
+//!
+static void refresh_hooks(void)
+{
+    int rc = 0;
+    int off = 0;
+    boolean changed = FALSE;
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event = NULL;
+
+    pthread_rwlock_rdlock(&hooks_lock);
+    {
+        if (hooks_inotify_fd < 0) {
+            changed = TRUE;
+        } else {
+            while ((rc = read(hooks_inotify_fd, events, sizeof(events))) > 0) {
+                changed = TRUE;
+                for (off = 0; off < rc; off += (sizeof(struct inotify_event) + event->len)) {
+                    event = (struct inotify_event *)(events + off);
+                    if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                        LOGWARN("hooks directory %s went away\n", hooks_path);
+                }
+            }
+        }
+    }
+    pthread_rwlock_unlock(&hooks_lock);
+
+    if (changed) {
+        pthread_rwlock_wrlock(&hooks_lock);
+        {
+            scan_hooks();
+        }
+        pthread_rwlock_unlock(&hooks_lock);
+    }
+}
+
+//!
+//! Stops the daemon of a hook, if it runs
+//!
+//! @param[in] h a pointer to the hook
+//!
+static void stop_hook_daemon(hook * h)
+{
+    int status = 0;
+
+    if (h->sock >= 0) {
+        // closing the socket is the signal for the daemon to exit
+        close(h->sock);
+        h->sock = -1;
+    }
+
+    if (h->pid > 0) {
+        if (timewait(h->pid, &status, 1) == 0) {
+            kill(h->pid, SIGKILL);
+            waitpid(h->pid, NULL, 0);
+        }
+        h->pid = 0;
+    }
+}
+
+//!
+//! Starts the daemon of a hook, as '<hook> daemon <eucalyptus directory>', with a socket
+//! connected to its standard input and output.
+//!
+//! @param[in] h a pointer to the hook
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int start_hook_daemon(hook * h)
+{
+    int fds[2] = { -1, -1 };
+    pid_t pid = 0;
+
+    if (socketpair(AF_UNIX, (SOCK_STREAM | SOCK_CLOEXEC), 0, fds) < 0) {
+        LOGERROR("cannot create a socket for hook daemon %s\n", h->path);
+        return (EUCA_ERROR);
+    }
+
+    if ((pid = fork()) < 0) {
+        LOGERROR("cannot fork hook daemon %s\n", h->path);
+        close(fds[0]);
+        close(fds[1]);
+        return (EUCA_ERROR);
+    }
+
+    if (pid == 0) {
+        // our end of the socket, and all others, are closed on exec
+        if ((dup2(fds[1], STDIN_FILENO) < 0) || (dup2(fds[1], STDOUT_FILENO) < 0))
+            _exit(127);
+        execl(h->path, h->path, "daemon", euca_path, NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    h->sock = fds[0];
+    h->pid = pid;
+    LOGINFO("started hook daemon %s (pid=%d)\n", h->path, pid);
+    return (EUCA_OK);
+}
+
+//!
+//! Hands an event to the daemon of a hook, starting it first if it is not running. The
+//! event goes out as one line, '<event>\t<eucalyptus directory>\t<parameter>\n', and the
+//! daemon answers with one line holding the exit code of the hook for the event (0 for
+//! success). A daemon which does not answer within HOOK_DAEMON_TIMEOUT_SEC is stopped.
+//!
+//! @param[in] h a pointer to the hook
+//! @param[in] event_name the event to work on
+//! @param[in] param1 the parameter of the event, may be NULL
+//!
+//! @return EUCA_OK if the daemon handled the event successfully or EUCA_ERROR otherwise
+//!
+static int call_hook_daemon(hook * h, const char *event_name, const char *param1)
+{
+    int rc = 0;
+    int len = 0;
+    int got = 0;
+    int code = -1;
+    char *p = NULL;
+    char line[EUCA_MAX_PATH * 2] = "";
+    char reply[64] = "";
+    struct pollfd pfd = { 0 };
+
+    len = snprintf(line, sizeof(line), "%s\t%s\t%s\n", event_name, euca_path, ((param1 != NULL) ? param1 : ""));
+    if ((len <= 0) || (len >= sizeof(line)))
+        return (EUCA_ERROR);
+
+    // the event must stay on one line
+    for (p = line; p < (line + len - 1); p++) {
+        if ((*p == '\n') || (*p == '\r'))
+            *p = ' ';
+    }
+
+    pthread_mutex_lock(&hooks_daemon_mutex);
+    {
+        if ((h->pid > 0) && (waitpid(h->pid, NULL, WNOHANG) != 0)) {
+            LOGWARN("hook daemon %s (pid=%d) exited, restarting it\n", h->path, h->pid);
+            h->pid = 0;                // already reaped
+            stop_hook_daemon(h);
+        }
+
+        if ((h->sock < 0) || (h->pid <= 0)) {
+            stop_hook_daemon(h);
+            rc = start_hook_daemon(h);
+        }
+
+        if ((rc == EUCA_OK) && (send(h->sock, line, len, MSG_NOSIGNAL) != len)) {
+            LOGERROR("cannot send event '%s' to hook daemon %s\n", event_name, h->path);
+            rc = EUCA_ERROR;
+        }
+
+        // read the answer, up to the end of its line
+        while ((rc == EUCA_OK) && ((got == 0) || (reply[got - 1] != '\n'))) {
+            pfd.fd = h->sock;
+            pfd.events = POLLIN;
+            if ((poll(&pfd, 1, (HOOK_DAEMON_TIMEOUT_SEC * 1000)) <= 0) || (got >= (sizeof(reply) - 1))) {
+                LOGERROR("no answer from hook daemon %s to event '%s'\n", h->path, event_name);
+                rc = EUCA_ERROR;
+            } else if ((len = read(h->sock, reply + got, (sizeof(reply) - 1 - got))) <= 0) {
+                LOGERROR("hook daemon %s went away while handling event '%s'\n", h->path, event_name);
+                rc = EUCA_ERROR;
+            } else {
+                got += len;
+                reply[got] = '\0';
+            }
+        }
+
+        if (rc == EUCA_OK) {
+            code = atoi(reply);
+        } else {
+            stop_hook_daemon(h);
+        }
+    }
+    pthread_mutex_unlock(&hooks_daemon_mutex);
+
+    if ((rc == EUCA_OK) && (code != 0)) {
+        LOGERROR("hook daemon %s failed event '%s %s' with %d\n", h->path, event_name, ((param1 != NULL) ? param1 : ""), code);
+        rc = EUCA_ERROR;
+    }
+    return (rc);
+}
+
 //!
 //! Execute a system command
 //!
+//! Every executable in the hooks directory is run, in turn, as '<hook> <event> <eucalyptus
+//! directory> <parameter>'. Hooks whose name ends with HOOK_DAEMON_SUFFIX are instead
+//! started once and kept running, and get the event through call_hook_daemon(), which
+//! saves a process spawn per event.
+//!
 //! @param[in] event_name the event to work on
 //! @param[in] param1 the parameters to pass to the command.
 //!
@@ -199,12 +502,8 @@ int init_hooks(const char *euca_dir, const char *hooks_dir)
 //!
 int call_hooks(const char *event_name, const char *param1)
 {
+    int i = 0;
     int rc = EUCA_OK;
-    DIR *dir = NULL;
-    char *entry_name = NULL;
-    char entry_path[EUCA_MAX_PATH] = "";
-    struct stat sb = { 0 };
-    struct dirent *dir_entry = NULL;
 
     assert(event_name);
     if (!initialized) {
@@ -212,32 +511,27 @@ int call_hooks(const char *event_name, const char *param1)
         return (EUCA_OK);
     }
 
-    if ((dir = opendir(hooks_path)) == NULL) {
-        return (EUCA_ERROR);
-    }
-
-    while ((dir_entry = readdir(dir)) != NULL) {
-        entry_name = dir_entry->d_name;
-
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name))
-            continue;                  // ignore known unrelated files
-
-        // get the path of the directory item
-        snprintf(entry_path, sizeof(entry_path), "%s/%s", hooks_path, entry_name);
-        if (stat(entry_path, &sb) == -1)
-            continue;                  // ignore access errors
-
-        // run the hook if...
-        if ((S_ISLNK(sb.st_mode) || S_ISREG(sb.st_mode))    // looks like a file or symlink
-            && (sb.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {  // is executable
-            LOGDEBUG("executing '%s %s %s %s'\n", entry_path, event_name, euca_path, ((param1 != NULL) ? param1 : ""));
-            if ((rc = euca_execlp(NULL, entry_path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), NULL)) != EUCA_OK) {
-                LOGERROR("cmd '%s %s %s %s' failed %d\n", entry_path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), rc);
-                break;
+    refresh_hooks();
+
+    pthread_rwlock_rdlock(&hooks_lock);
+    {
+        if (!hooks_dir_ok)
+            rc = EUCA_ERROR;
+
+        for (i = 0; (i < hooks_len) && (rc == EUCA_OK); i++) {
+            if (hooks[i].daemon) {
+                LOGDEBUG("sending '%s %s %s' to hook daemon %s\n", event_name, euca_path, ((param1 != NULL) ? param1 : ""), hooks[i].path);
+                rc = call_hook_daemon(&hooks[i], event_name, param1);
+            } else {
+                LOGDEBUG("executing '%s %s %s %s'\n", hooks[i].path, event_name, euca_path, ((param1 != NULL) ? param1 : ""));
+                if ((rc = euca_execlp(NULL, hooks[i].path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), NULL)) != EUCA_OK) {
+                    LOGERROR("cmd '%s %s %s %s' failed %d\n", hooks[i].path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), rc);
+                }
             }
         }
     }
-    closedir(dir);
+    pthread_rwlock_unlock(&hooks_lock);
+
     return ((rc == EUCA_OK) ? EUCA_OK : EUCA_ERROR);
 }
 
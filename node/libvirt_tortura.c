@@ -65,7 +65,27 @@
 
 //!
 //! @file node/libvirt_tortura.c
-//! Need to provide description
+//! Hypervisor access benchmark, and torture test, for the connection strategies of the NC
+//!
+//! Operation threads run the libvirt call sequence of an instance's life in the NC: create
+//! the domain, look it up and get its info and XML as the monitoring thread does, attach
+//! and detach a disk as for a volume, then destroy it. Query threads meanwhile list the
+//! domains and get their info, as the sensor and DescribeInstances paths do. Every call
+//! goes through one of the connection strategies below and its latency is recorded, along
+//! with the time taken to acquire the connection:
+//!     \li probe - lock_hypervisor_conn() without an event loop: one connection for
+//!         everything, serialized, checked with a forked probe and reopened before every use;
+//!     \li reopen - the same without the forked probe;
+//!     \li keepalive - lock_hypervisor_conn() with the event loop: the connection is reused
+//!         while keepalive pings say libvirtd answers;
+//!     \li query - keepalive plus lock_hypervisor_query_conn(): queries use a second,
+//!         shared connection, LIBVIRT_QUERY_CALLERS at a time, without waiting for operations;
+//!     \li perthread - every thread keeps its own connection and nothing is serialized.
+//!
+//! Each result line starts with 'libvirt_bench' and holds key=value pairs only. Calls that
+//! take longer than LIBVIRT_TIMEOUT_SEC, which the NC would treat as a hung libvirtd, are
+//! counted as stalls. With -c, a checker thread keeps forcing the shared connection to be
+//! reopened, as the original torture test did, to shake out hangs.
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -89,6 +109,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <sys/vfs.h>                   /* statfs */
 #include <signal.h>                    /* SIGINT */
 #include <linux/limits.h>
@@ -102,10 +123,16 @@
 \*----------------------------------------------------------------------------*/
 
 #define MAXDOMS                                   100
-#define ITERS                                     300
-#define SITERS                                     20
-#define IITERS                                   1000
-#define THREADS                                    11
+#define MAX_THREADS                                64   //!< Maximum number of operation or query threads
+#define ITERS                                      20   //!< Default number of instance lifecycles per operation thread
+#define THREADS                                     4   //!< Default number of operation threads
+#define QTHREADS                                    4   //!< Default number of query threads
+#define SAMPLES                                  1024   //!< Initial size of the latency sample arrays, grown as needed
+
+#define LIBVIRT_TIMEOUT_SEC                         5   //!< as in handlers.c, calls taking longer count as stalls
+#define LIBVIRT_KEEPALIVE_INTERVAL_SEC              5   //!< as in handlers.c
+#define LIBVIRT_KEEPALIVE_COUNT                     3   //!< as in handlers.c
+#define LIBVIRT_QUERY_CALLERS                       4   //!< as in handlers.c
 
 #define DUMMY_DISK_FILE                          "libvirt_tortura-dummy-disk"
 #define DUMMY_DISK_SIZE_BYTES                    10000000
@@ -122,12 +149,63 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Connection strategies, see the file description
+typedef enum strategy_t {
+    STRATEGY_PROBE,
+    STRATEGY_REOPEN,
+    STRATEGY_KEEPALIVE,
+    STRATEGY_QUERY,
+    STRATEGY_PERTHREAD,
+    STRATEGIES,
+} strategy;
+
+//! Timed calls, the connection acquisitions included
+typedef enum call_t {
+    CALL_LOCK,
+    CALL_CREATE,
+    CALL_LOOKUP,
+    CALL_GETINFO,
+    CALL_GETXML,
+    CALL_ATTACH,
+    CALL_DETACH,
+    CALL_DESTROY,
+    CALL_LIFECYCLE,
+    CALL_QUERY_LOCK,
+    CALL_LIST,
+    CALL_QUERY_INFO,
+    CALLS,
+} call;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A hypervisor connection, as hypervisorConn in handlers.c
+typedef struct hypConn_t {
+    virConnectPtr conn;                //!< the connection or NULL if it is not open
+    volatile int closed;               //!< set by the close callback when libvirt drops the connection
+} hypConn;
+
+//! Latencies of one call
+typedef struct samples_t {
+    long long *usec;                   //!< the latencies, in microseconds
+    int len;                           //!< number of entries in usec[]
+    int size;                          //!< allocated size of usec[]
+    int failures;                      //!< number of calls that failed
+    int stalls;                        //!< number of calls that took longer than LIBVIRT_TIMEOUT_SEC
+} samples;
+
+//! State of one thread
+typedef struct worker_t {
+    pthread_t thread;                  //!< the thread
+    long long tid;                     //!< index of the thread
+    hypConn own;                       //!< connection of the thread, for STRATEGY_PERTHREAD
+    char disk[PATH_MAX];               //!< root disk of the domains of an operation thread
+    char volume[PATH_MAX];             //!< disk attached to the domains of an operation thread
+} worker;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -142,8 +220,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-virConnectPtr conn = NULL;
-char uri[] = "qemu:///system";
+char *uri = "qemu:///system";
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -151,7 +228,28 @@ char uri[] = "qemu:///system";
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
+static const char *strategy_names[STRATEGIES] = { "probe", "reopen", "keepalive", "query", "perthread" };
+
+static const char *call_names[CALLS] = {
+    "lock", "create", "lookup", "getinfo", "getxml", "attach", "detach", "destroy", "lifecycle", "query_lock", "list", "query_info"
+};
+
+//! @{
+//! @name Settings, from the command line
+static int iters = ITERS;              //!< instance lifecycles per operation thread
+static int boot_ms = 0;                //!< time a domain runs before being queried and attached to
+static strategy current = STRATEGY_PROBE;   //!< strategy of the run in progress
+static int keepalive = 0;              //!< set once the libvirt event loop runs
+//! @}
+
+static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< serializes the calls on op_conn, as hyp_sem
+static pthread_mutex_t query_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< protects query_conn, as hyp_query_mutex
+static pthread_mutex_t samples_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< protects results[]
+static sem_t query_sem;                //!< admits LIBVIRT_QUERY_CALLERS query threads, as hyp_query_sem
+static hypConn op_conn = { NULL, 0 };  //!< connection of the operations
+static hypConn query_conn = { NULL, 0 };    //!< shared connection of the queries, for STRATEGY_QUERY
+static samples results[CALLS];         //!< latencies of the run in progress
+static volatile int running = 0;       //!< number of operation threads still going
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -159,10 +257,27 @@ static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-static virConnectPtr *check_hypervisor_conn(void);
+static long long time_usec(void);
+static void record(call c, long long start_usec, int failed);
+static void *event_thread(void *ptr);
+static void close_callback(virConnectPtr conn, int reason, void *opaque);
+static void reopen_hypervisor_conn(hypConn * hc);
+static int probe_hypervisor_conn(void);
+static int check_hypervisor_conn(hypConn * hc);
+static virConnectPtr lock_conn(worker * w);
+static void unlock_conn(worker * w);
+static virConnectPtr lock_query_conn(worker * w);
+static void unlock_query_conn(worker * w, virConnectPtr conn);
+static void close_conn(hypConn * hc);
+static int make_disk(const char *file_name);
+static virDomainPtr lookup(worker * w, virConnectPtr conn, const char *name);
 static void *checker_thread(void *ptr);
 static void *tortura_thread(void *ptr);
 static void *startup_thread(void *ptr);
+static int compare_usec(const void *a, const void *b);
+static void report(FILE * out, int threads, int qthreads, long long elapsed_usec);
+static int run(FILE * out, worker * workers, int threads, int qthreads, int checker);
+static void usage(void);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -177,145 +292,425 @@ static void *startup_thread(void *ptr);
 \*----------------------------------------------------------------------------*/
 
 //!
+//! Microseconds on the monotonic clock
 //!
+//! @return the current time in microseconds
 //!
-//! @return a pointer to the LIBVIRT connection structure if successful or NULL otherwize
+static long long time_usec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000);
+}
+
 //!
-//! @pre
+//! Records the latency of a call that started at start_usec
 //!
-//! @note
+//! @param[in] c the call
+//! @param[in] start_usec time_usec() when the call started
+//! @param[in] failed non-zero if the call failed
 //!
-static virConnectPtr *check_hypervisor_conn(void)
+static void record(call c, long long start_usec, int failed)
 {
-    int rc = 0;
+    long long usec = time_usec() - start_usec;
+    long long *grown = NULL;
+    samples *s = &(results[c]);
 
-    pthread_mutex_lock(&check_mutex);
+    pthread_mutex_lock(&samples_mutex);
     {
-        if (conn) {
-            if ((rc = virConnectClose(conn)) != 0) {
-                printf("refcount on close was non-zero: %d\n", rc);
+        if (failed)
+            s->failures++;
+        if (usec > (LIBVIRT_TIMEOUT_SEC * 1000000LL))
+            s->stalls++;
+        if (s->len == s->size) {
+            if ((grown = realloc(s->usec, (s->size ? (s->size * 2) : SAMPLES) * sizeof(long long))) != NULL) {
+                s->usec = grown;
+                s->size = (s->size ? (s->size * 2) : SAMPLES);
             }
-
-            conn = NULL;
         }
+        if (s->len < s->size)
+            s->usec[s->len++] = usec;
+    }
+    pthread_mutex_unlock(&samples_mutex);
+}
 
-        if ((conn = virConnectOpen(uri)) == NULL) {
-            printf("failed to connect to %s\n", uri);
-        }
+//!
+//! Runs the libvirt event loop, which sends the keepalive pings and the close callbacks
+//!
+//! @param[in] ptr unused
+//!
+//! @return Always returns NULL
+//!
+static void *event_thread(void *ptr)
+{
+    for (;;) {
+        if (virEventRunDefaultImpl() != 0)
+            sleep(1);
     }
-    pthread_mutex_unlock(&check_mutex);
-    return (&conn);
+    return (NULL);
 }
 
 //!
+//! Invoked by libvirt, from the event loop, when it closes a connection on its own
+//!
+//! @param[in] conn the connection that was closed
+//! @param[in] reason VIR_CONNECT_CLOSE_REASON_* code
+//! @param[in] opaque the hypConn structure of the connection
 //!
+static void close_callback(virConnectPtr conn, int reason, void *opaque)
+{
+    printf("libvirt closed a hypervisor connection (reason=%d)\n", reason);
+    ((hypConn *) opaque)->closed = 1;
+}
+
 //!
-//! @param[in] ptr
+//! Closes and reopens a hypervisor connection, with keepalive when the event loop runs
 //!
-//! @return Always returns NULL
+//! @param[in] hc the connection
 //!
-static void *checker_thread(void *ptr)
+static void reopen_hypervisor_conn(hypConn * hc)
 {
-    int iter = 0;
+    int rc = 0;
 
-    for (iter = 0; iter < IITERS; iter++) {
-        printf("checker thread starting iteration %d\n", iter);
-        check_hypervisor_conn();
+    close_conn(hc);
+    if ((hc->conn = virConnectOpen(uri)) == NULL) {
+        printf("failed to connect to %s\n", uri);
+        return;
     }
 
-    return (NULL);
+    if (keepalive && (current != STRATEGY_PROBE) && (current != STRATEGY_REOPEN)) {
+        if ((rc = virConnectSetKeepAlive(hc->conn, LIBVIRT_KEEPALIVE_INTERVAL_SEC, LIBVIRT_KEEPALIVE_COUNT)) != 0)
+            printf("keepalive not supported on hypervisor connection (rc=%d)\n", rc);
+        virConnectRegisterCloseCallback(hc->conn, close_callback, hc, NULL);
+    }
 }
 
 //!
+//! Opens and closes a connection in a forked process, as check_hypervisor_conn() in
+//! handlers.c does before reopening the connection of the NC
 //!
+//! @return 0 if the probe succeeded or -1 if it failed or did not finish in LIBVIRT_TIMEOUT_SEC
 //!
-//! @param[in] ptr
+static int probe_hypervisor_conn(void)
+{
+    int i = 0;
+    int status = 0;
+    pid_t cpid = 0;
+    pid_t rc = 0;
+    virConnectPtr tmp_conn = NULL;
+
+    if ((cpid = fork()) < 0) {
+        printf("failed to fork to check hypervisor connection\n");
+        return (-1);
+    } else if (cpid == 0) {
+        if ((tmp_conn = virConnectOpen(uri)) == NULL)
+            _exit(1);
+        virConnectClose(tmp_conn);
+        _exit(0);
+    }
+
+    for (i = 0; i < (LIBVIRT_TIMEOUT_SEC * 1000); i++) {
+        if ((rc = waitpid(cpid, &status, WNOHANG)) != 0)
+            break;
+        usleep(1000);
+    }
+
+    if (rc == 0) {
+        printf("timed out waiting for hypervisor checker pid=%d\n", cpid);
+        kill(cpid, SIGKILL);
+        waitpid(cpid, &status, 0);
+        return (-1);
+    }
+    return ((rc == cpid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : -1;
+}
+
 //!
-//! @return Always returns NULL
+//! Makes sure a connection is usable according to the current strategy
 //!
-static void *tortura_thread(void *ptr)
+//! @param[in] hc the connection, whose lock the caller holds
+//!
+//! @return 0 if the connection can be used or -1 otherwise
+//!
+static int check_hypervisor_conn(hypConn * hc)
 {
-    int i = 0;
-    int iter = 0;
-    int error = 0;
-    int num_doms = 0;
-    int dom_ids[MAXDOMS] = { 0 };
-    long long tid = (*(long long *)ptr);
-    virDomainPtr dom[MAXDOMS] = { NULL };
-    virDomainInfo info[MAXDOMS] = { 0 };
+    switch (current) {
+    case STRATEGY_PROBE:
+        if (probe_hypervisor_conn() != 0)
+            return (-1);
+        reopen_hypervisor_conn(hc);
+        break;
+    case STRATEGY_REOPEN:
+        reopen_hypervisor_conn(hc);
+        break;
+    default:
+        if (!hc->conn || hc->closed || (virConnectIsAlive(hc->conn) != 1))
+            reopen_hypervisor_conn(hc);
+        break;
+    }
+    return ((hc->conn != NULL) ? 0 : -1);
+}
 
-    check_hypervisor_conn();
-    for (iter = 0; iter < ITERS; iter++) {
-        printf("thread %lld starting iteration %d\n", tid, iter);
+//!
+//! Acquires the connection for a domain operation, as lock_hypervisor_conn()
+//!
+//! @param[in] w the calling thread
+//!
+//! @return the connection or NULL on failure, in which case unlock_conn() must not be called
+//!
+static virConnectPtr lock_conn(worker * w)
+{
+    long long start = time_usec();
+    virConnectPtr conn = NULL;
 
+    if (current == STRATEGY_PERTHREAD) {
+        if (check_hypervisor_conn(&(w->own)) == 0)
+            conn = w->own.conn;
+    } else {
         pthread_mutex_lock(&check_mutex);
-        {
-            num_doms = virConnectListDomains(conn, dom_ids, MAXDOMS);
+        if (check_hypervisor_conn(&op_conn) == 0) {
+            conn = op_conn.conn;
+        } else {
+            pthread_mutex_unlock(&check_mutex);
         }
+    }
+    record(CALL_LOCK, start, (conn == NULL));
+    return (conn);
+}
+
+//!
+//! Releases the connection obtained from lock_conn()
+//!
+//! @param[in] w the calling thread
+//!
+static void unlock_conn(worker * w)
+{
+    if (current != STRATEGY_PERTHREAD)
         pthread_mutex_unlock(&check_mutex);
+}
 
-        for (i = 0; i < num_doms; i++) {
-            pthread_mutex_lock(&check_mutex);
-            {
-                dom[i] = virDomainLookupByID(conn, dom_ids[i]);
-            }
+//!
+//! Acquires a connection for queries: the shared query connection with STRATEGY_QUERY, as
+//! lock_hypervisor_query_conn(), and the operations connection otherwise
+//!
+//! @param[in] w the calling thread
+//!
+//! @return the connection or NULL on failure, in which case unlock_query_conn() must not be called
+//!
+static virConnectPtr lock_query_conn(worker * w)
+{
+    long long start = time_usec();
+    virConnectPtr conn = NULL;
+
+    if (current == STRATEGY_QUERY) {
+        sem_wait(&query_sem);
+        pthread_mutex_lock(&query_mutex);
+        if (check_hypervisor_conn(&query_conn) == 0) {
+            // the reference keeps the connection valid for us even if another caller reopens it
+            conn = query_conn.conn;
+            virConnectRef(conn);
+        }
+        pthread_mutex_unlock(&query_mutex);
+        if (conn == NULL)
+            sem_post(&query_sem);
+    } else if (current == STRATEGY_PERTHREAD) {
+        if (check_hypervisor_conn(&(w->own)) == 0)
+            conn = w->own.conn;
+    } else {
+        pthread_mutex_lock(&check_mutex);
+        if (check_hypervisor_conn(&op_conn) == 0) {
+            conn = op_conn.conn;
+        } else {
             pthread_mutex_unlock(&check_mutex);
+        }
+    }
+    record(CALL_QUERY_LOCK, start, (conn == NULL));
+    return (conn);
+}
 
-            if (!dom[i]) {
-                printf("failed to look up domain %d\n", dom_ids[i]);
-                continue;
-            }
+//!
+//! Releases the connection obtained from lock_query_conn()
+//!
+//! @param[in] w the calling thread
+//! @param[in] conn the connection returned by lock_query_conn()
+//!
+static void unlock_query_conn(worker * w, virConnectPtr conn)
+{
+    if (current == STRATEGY_QUERY) {
+        virConnectClose(conn);
+        sem_post(&query_sem);
+    } else if (current != STRATEGY_PERTHREAD) {
+        pthread_mutex_unlock(&check_mutex);
+    }
+}
+
+//!
+//! Closes a connection, if open
+//!
+//! @param[in] hc the connection
+//!
+static void close_conn(hypConn * hc)
+{
+    int rc = 0;
+
+    if (hc->conn) {
+        if (keepalive)
+            virConnectUnregisterCloseCallback(hc->conn, close_callback);
+        if ((rc = virConnectClose(hc->conn)) != 0) {
+            printf("refcount on close was non-zero: %d\n", rc);
         }
+    }
+    hc->conn = NULL;
+    hc->closed = 0;
+}
 
-        for (i = 0; i < num_doms; i++) {
-            pthread_mutex_lock(&check_mutex);
-            {
-                error = virDomainGetInfo(dom[i], &info[i]);
-            }
-            pthread_mutex_unlock(&check_mutex);
+//!
+//! Creates a sparse file of DUMMY_DISK_SIZE_BYTES to serve as a domain disk
+//!
+//! @param[in] file_name path of the file
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int make_disk(const char *file_name)
+{
+    int fd = 0;
 
-            if (error < 0) {
-                printf("failed to get info on domain %d\n", dom_ids[i]);
-                continue;
-            }
+    umask(0000);
+    if ((fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+        printf("failed to create %s\n", file_name);
+        perror("libvirt_tortura");
+        return (-1);
+    }
+
+    if (lseek(fd, DUMMY_DISK_SIZE_BYTES, SEEK_SET) == ((off_t) - 1)) {
+        printf("failed to seek in %s\n", file_name);
+        perror("libvirt_tortura");
+        close(fd);
+        return (-1);
+    }
+
+    if (write(fd, "x", 1) != 1) {
+        printf("failed to write to %s\n", file_name);
+        perror("libvirt_tortura");
+        close(fd);
+        return (-1);
+    }
+
+    close(fd);
+    return (0);
+}
+
+//!
+//! Looks a domain up by name, as the NC does before every operation on an instance
+//!
+//! @param[in] w the calling thread
+//! @param[in] conn the connection, locked by the caller
+//! @param[in] name the domain name
+//!
+//! @return the domain, to be released with virDomainFree(), or NULL if it was not found
+//!
+static virDomainPtr lookup(worker * w, virConnectPtr conn, const char *name)
+{
+    long long start = time_usec();
+    virDomainPtr dom = virDomainLookupByName(conn, name);
+
+    record(CALL_LOOKUP, start, (dom == NULL));
+    return (dom);
+}
+
+//!
+//! Keeps forcing the operations connection to be reopened, racing the other threads
+//!
+//! @param[in] ptr unused
+//!
+//! @return Always returns NULL
+//!
+static void *checker_thread(void *ptr)
+{
+    while (running > 0) {
+        pthread_mutex_lock(&check_mutex);
+        {
+            reopen_hypervisor_conn(&op_conn);
         }
+        pthread_mutex_unlock(&check_mutex);
+        usleep(10000);
+    }
 
-        for (i = 0; i < num_doms; i++) {
-            pthread_mutex_lock(&check_mutex);
-            {
-                error = virDomainFree(dom[i]);
-            }
-            pthread_mutex_unlock(&check_mutex);
+    return (NULL);
+}
 
-            if (error < 0) {
-                printf("failed to close domain %d\n", dom_ids[i]);
-                continue;
+//!
+//! Query thread: lists the domains and gets the info of each, on a connection acquired for
+//! the whole pass, until the operation threads are done
+//!
+//! @param[in] ptr the worker of the thread
+//!
+//! @return Always returns NULL
+//!
+static void *tortura_thread(void *ptr)
+{
+    int i = 0;
+    int error = 0;
+    int num_doms = 0;
+    int dom_ids[MAXDOMS] = { 0 };
+    long long start = 0;
+    worker *w = ((worker *) ptr);
+    virDomainPtr dom = NULL;
+    virDomainInfo info = { 0 };
+    virConnectPtr conn = NULL;
+
+    while (running > 0) {
+        if ((conn = lock_query_conn(w)) == NULL) {
+            usleep(100000);
+            continue;
+        }
+
+        start = time_usec();
+        num_doms = virConnectListDomains(conn, dom_ids, MAXDOMS);
+        record(CALL_LIST, start, (num_doms < 0));
+
+        for (i = 0; i < num_doms; i++) {
+            start = time_usec();
+            if ((dom = virDomainLookupByID(conn, dom_ids[i])) != NULL) {
+                error = virDomainGetInfo(dom, &info);
+                virDomainFree(dom);
             }
+            // the domain may be destroyed by an operation thread under our feet, that is no failure
+            record(CALL_QUERY_INFO, start, ((dom != NULL) && (error < 0)));
         }
+        unlock_query_conn(w, conn);
     }
 
+    close_conn(&(w->own));
     return (NULL);
 }
 
 //!
+//! Operation thread: runs 'iters' instance lifecycles, taking the connection for each call
+//! as the NC does
 //!
-//!
-//! @param[in] arg
+//! @param[in] arg the worker of the thread
 //!
 //! @return Always returns NULL
 //!
 static void *startup_thread(void *arg)
 {
-    int fd = 0;
     int iter = 0;
-    long long tid = (*(long long *)arg);
+    int error = 0;
+    long long start = 0;
+    long long lifecycle = 0;
+    worker *w = ((worker *) arg);
     virDomainPtr dom = NULL;
-    char file_name[1024] = { 0 };
-    char xml[4096] = { 0 };
+    virConnectPtr conn = NULL;
+    virDomainInfo info = { 0 };
+    char *desc = NULL;
+    char name[64] = "";
+    char xml[4096 + PATH_MAX] = { 0 };
+    char volume_xml[PATH_MAX + 128] = { 0 };
     char *xml_template =
         "<?xml version='1.0' encoding='UTF-8'?>"
         "<domain type='kvm'>"
-        "  <name>tortura-%04lld</name>"
+        "  <name>%s</name>"
         "  <description>Eucalyptus instance i-XXX</description>"
         "  <os>"
         "    <type>hvm</type>"
@@ -330,62 +725,203 @@ static void *startup_thread(void *arg)
         "  <vcpu>1</vcpu>"
         "  <memory>52428</memory>"
         "  <devices>" "    <disk device='disk'>" "      <source file='%s'/>" "      <target bus='virtio' dev='vda'/>" "    </disk>" "  </devices>" "</domain>";
+    char *volume_template = "<disk type='file' device='disk'>" "  <source file='%s'/>" "  <target bus='virtio' dev='vdb'/>" "</disk>";
 
-    snprintf(file_name, sizeof(file_name), "%s/%s-%lld", get_current_dir_name(), DUMMY_DISK_FILE, tid);
+    snprintf(volume_xml, sizeof(volume_xml), volume_template, w->volume);
+    for (iter = 0; iter < iters; iter++) {
+        snprintf(name, sizeof(name), "tortura-%04lld-%s", w->tid, strategy_names[current]);
+        snprintf(xml, sizeof(xml), xml_template, name, w->disk);
+        lifecycle = time_usec();
 
-    umask(0000);
-    if ((fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
-        printf("failed to create %s\n", DUMMY_DISK_FILE);
-        perror("libvirt_tortura");
-        exit(1);
-    }
+        if ((conn = lock_conn(w)) == NULL)
+            continue;
+        start = time_usec();
+        dom = virDomainCreateLinux(conn, xml, 0);
+        record(CALL_CREATE, start, (dom == NULL));
+        if (dom)
+            virDomainFree(dom);
+        unlock_conn(w);
+        if (dom == NULL) {
+            printf("ERROR: failed to start domain %s\n", name);
+            continue;
+        }
 
-    if (lseek(fd, DUMMY_DISK_SIZE_BYTES, SEEK_SET) == ((off_t) - 1)) {
-        printf("failed to seek in %s\n", DUMMY_DISK_FILE);
-        perror("libvirt_tortura");
-        exit(1);
-    }
+        if (boot_ms > 0)
+            usleep(boot_ms * 1000);
 
-    if (write(fd, "x", 1) != 1) {
-        printf("failed to write to %s\n", DUMMY_DISK_FILE);
-        perror("libvirt_tortura");
-        exit(1);
-    }
+        if ((conn = lock_conn(w)) != NULL) {
+            if ((dom = lookup(w, conn, name)) != NULL) {
+                start = time_usec();
+                error = virDomainGetInfo(dom, &info);
+                record(CALL_GETINFO, start, (error < 0));
+                virDomainFree(dom);
+            }
+            unlock_conn(w);
+        }
 
-    close(fd);
+        if ((conn = lock_conn(w)) != NULL) {
+            if ((dom = lookup(w, conn, name)) != NULL) {
+                start = time_usec();
+                desc = virDomainGetXMLDesc(dom, 0);
+                record(CALL_GETXML, start, (desc == NULL));
+                free(desc);
+                virDomainFree(dom);
+            }
+            unlock_conn(w);
+        }
 
-    sync();
+        if ((conn = lock_conn(w)) != NULL) {
+            if ((dom = lookup(w, conn, name)) != NULL) {
+                start = time_usec();
+                error = virDomainAttachDevice(dom, volume_xml);
+                record(CALL_ATTACH, start, (error != 0));
+                virDomainFree(dom);
+            }
+            unlock_conn(w);
+        }
 
-    check_hypervisor_conn();
-    for (iter = 0; iter < SITERS; iter++) {
-        printf("startup thread %lld starting iteration %d\n", tid, iter);
-        snprintf(xml, sizeof(xml), xml_template, tid, file_name);
+        if ((conn = lock_conn(w)) != NULL) {
+            if ((dom = lookup(w, conn, name)) != NULL) {
+                start = time_usec();
+                error = virDomainDetachDevice(dom, volume_xml);
+                record(CALL_DETACH, start, (error != 0));
+                virDomainFree(dom);
+            }
+            unlock_conn(w);
+        }
 
-        pthread_mutex_lock(&check_mutex);
-        {
-            dom = virDomainCreateLinux(conn, xml, 0);
+        error = -1;
+        if ((conn = lock_conn(w)) != NULL) {
+            if ((dom = lookup(w, conn, name)) != NULL) {
+                start = time_usec();
+                error = virDomainDestroy(dom);
+                record(CALL_DESTROY, start, (error != 0));
+                virDomainFree(dom);
+            }
+            unlock_conn(w);
         }
-        pthread_mutex_unlock(&check_mutex);
+        record(CALL_LIFECYCLE, lifecycle, (error != 0));
+    }
 
-        sleep(3);
+    close_conn(&(w->own));
+    __sync_fetch_and_sub(&running, 1);
+    return (NULL);
+}
 
-        if (dom == NULL) {
-            printf("ERROR: failed to start domain\n");
-            continue;
+//!
+//! qsort() comparator of latencies
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return -1, 0 or 1 as a is lower, equal or higher than b
+//!
+static int compare_usec(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints one result line per call made in the run, and resets the results
+//!
+//! @param[in] out stream to print to
+//! @param[in] threads number of operation threads
+//! @param[in] qthreads number of query threads
+//! @param[in] elapsed_usec wall-clock time of the run
+//!
+static void report(FILE * out, int threads, int qthreads, long long elapsed_usec)
+{
+    int c = 0;
+    int i = 0;
+    long long total = 0;
+    samples *s = NULL;
+
+    for (c = 0; c < CALLS; c++) {
+        s = &(results[c]);
+        if (s->len > 0) {
+            qsort(s->usec, s->len, sizeof(long long), compare_usec);
+            for (i = 0, total = 0; i < s->len; i++)
+                total += s->usec[i];
+
+#define _PCT(_F)                       (s->usec[(((int)((_F) * s->len)) < s->len) ? ((int)((_F) * s->len)) : (s->len - 1)])
+            fprintf(out, "libvirt_bench strategy=%s call=%s threads=%d query_threads=%d iters=%d calls=%d failures=%d stalls=%d calls_per_sec=%.1f "
+                    "mean_us=%.1f p50_us=%lld p90_us=%lld p99_us=%lld p999_us=%lld max_us=%lld\n", strategy_names[current], call_names[c], threads, qthreads, iters,
+                    s->len, s->failures, s->stalls, ((elapsed_usec > 0) ? (s->len * 1000000.0 / elapsed_usec) : 0.0), ((double)total / s->len), _PCT(0.50), _PCT(0.90),
+                    _PCT(0.99), _PCT(0.999), _PCT(1.0));
+#undef _PCT
         }
+        free(s->usec);
+        memset(s, 0, sizeof(samples));
+    }
+    fflush(out);
+}
 
-        pthread_mutex_lock(&check_mutex);
-        {
-            virDomainDestroy(dom);
-            virDomainFree(dom);
-            dom = NULL;
+//!
+//! Runs the operation, query and checker threads with the current strategy and reports
+//!
+//! @param[in] out stream to print to
+//! @param[in] workers 'threads' operation workers followed by 'qthreads' query workers
+//! @param[in] threads number of operation threads
+//! @param[in] qthreads number of query threads
+//! @param[in] checker non-zero to start the checker thread
+//!
+//! @return the number of threads that could not be started
+//!
+static int run(FILE * out, worker * workers, int threads, int qthreads, int checker)
+{
+    int j = 0;
+    int errors = 0;
+    long long start = 0;
+    pthread_t checker_tid = { 0 };
+
+    printf("spawning %d operation and %d query threads with the %s strategy\n", threads, qthreads, strategy_names[current]);
+
+    start = time_usec();
+    running = threads;
+    for (j = 0; j < threads; j++) {
+        if (pthread_create(&(workers[j].thread), NULL, startup_thread, &(workers[j])) != 0) {
+            printf("failed to start operation thread %d\n", j);
+            workers[j].thread = 0;
+            __sync_fetch_and_sub(&running, 1);
+            errors++;
         }
-        pthread_mutex_unlock(&check_mutex);
+    }
+    for (j = threads; j < (threads + qthreads); j++) {
+        if (pthread_create(&(workers[j].thread), NULL, tortura_thread, &(workers[j])) != 0) {
+            printf("failed to start query thread %d\n", j);
+            workers[j].thread = 0;
+            errors++;
+        }
+    }
+    if (checker && (current != STRATEGY_PERTHREAD) && (pthread_create(&checker_tid, NULL, checker_thread, NULL) != 0)) {
+        printf("failed to start the checker thread\n");
+        checker = 0;
+        errors++;
     }
 
-    unlink(file_name);
+    for (j = 0; j < (threads + qthreads); j++) {
+        if (workers[j].thread)
+            pthread_join(workers[j].thread, NULL);
+    }
+    if (checker && (current != STRATEGY_PERTHREAD))
+        pthread_join(checker_tid, NULL);
 
-    return (NULL);
+    report(out, threads, qthreads, (time_usec() - start));
+    close_conn(&op_conn);
+    close_conn(&query_conn);
+    return (errors);
+}
+
+//!
+//! Prints the usage of the application
+//!
+static void usage(void)
+{
+    printf("Usage: libvirt_tortura [-u uri] [-s probe,reopen,keepalive,query,perthread] [-t threads] [-q query-threads] [-i iterations]\n"
+           "                       [-b boot-ms] [-c] [-o file]\n");
 }
 
 //!
@@ -394,35 +930,123 @@ static void *startup_thread(void *arg)
 //! @param[in] argc the number of parameter passed on the command line
 //! @param[in] argv the list of arguments
 //!
-//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//! @return the number of errors
 //!
 int main(int argc, char **argv)
 {
     int j = 0;
-    int thread_par_sum = 0;
-    long long thread_par[THREADS] = { 0 };
-    pthread_t threads[THREADS] = { 0 };
+    int ch = 0;
+    int errors = 0;
+    int checker = 0;
+    int threads = THREADS;
+    int qthreads = QTHREADS;
+    int selected[STRATEGIES] = { 0 };
+    char *strategies = "probe,keepalive,query,perthread";
+    char *list = NULL;
+    char *item = NULL;
+    char *saveptr = NULL;
+    char *cwd = NULL;
+    FILE *out = stdout;
+    pthread_t event_tid = { 0 };
+    worker *workers = NULL;
 
-    printf("spawning %d competing threads\n", THREADS);
+    while ((ch = getopt(argc, argv, "u:s:t:q:i:b:co:h")) != -1) {
+        switch (ch) {
+        case 'u':
+            uri = optarg;
+            break;
+        case 's':
+            strategies = optarg;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'q':
+            qthreads = atoi(optarg);
+            break;
+        case 'i':
+            iters = atoi(optarg);
+            break;
+        case 'b':
+            boot_ms = atoi(optarg);
+            break;
+        case 'c':
+            checker = 1;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            usage();
+            return (1);
+        }
+    }
 
-    for (j = 0; j < THREADS; j++) {
-        thread_par[j] = j;
-        if (j == 0) {
-            pthread_create(&threads[j], NULL, checker_thread, (void *)&thread_par[j]);
-        } else {
-            if ((j % 2) == 0) {
-                pthread_create(&threads[j], NULL, tortura_thread, (void *)&thread_par[j]);
-            } else {
-                pthread_create(&threads[j], NULL, startup_thread, (void *)&thread_par[j]);
+    if ((threads < 1) || (threads > MAX_THREADS) || (qthreads < 0) || (qthreads > MAX_THREADS) || (iters < 1) || (boot_ms < 0)) {
+        printf("ERROR: thread counts must be within 1 (0 for queries) and %d and the iteration count must be positive\n", MAX_THREADS);
+        return (1);
+    }
+
+    list = strdup(strategies);
+    for (item = strtok_r(list, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        for (j = 0; (j < STRATEGIES) && strcmp(item, strategy_names[j]); j++) ;
+        if (j == STRATEGIES) {
+            printf("ERROR: unknown strategy '%s'\n", item);
+            usage();
+            return (1);
+        }
+        selected[j] = 1;
+    }
+    free(list);
+
+    // as in init_hypervisor_events(), the event loop must be registered before the first connection
+    if ((virEventRegisterDefaultImpl() == 0) && (pthread_create(&event_tid, NULL, event_thread, NULL) == 0)) {
+        pthread_detach(event_tid);
+        keepalive = 1;
+    } else if (selected[STRATEGY_KEEPALIVE] || selected[STRATEGY_QUERY] || selected[STRATEGY_PERTHREAD]) {
+        printf("WARNING: no libvirt event loop, dead connections will only be detected by virConnectIsAlive()\n");
+    }
+    sem_init(&query_sem, 0, LIBVIRT_QUERY_CALLERS);
+
+    if ((workers = calloc(threads + qthreads, sizeof(worker))) == NULL) {
+        printf("ERROR: out of memory\n");
+        return (1);
+    }
+
+    cwd = get_current_dir_name();
+    for (j = 0; j < (threads + qthreads); j++) {
+        workers[j].tid = j;
+        if (j < threads) {
+            snprintf(workers[j].disk, sizeof(workers[j].disk), "%s/%s-%d", cwd, DUMMY_DISK_FILE, j);
+            snprintf(workers[j].volume, sizeof(workers[j].volume), "%s/%s-%d-vol", cwd, DUMMY_DISK_FILE, j);
+            if (make_disk(workers[j].disk) || make_disk(workers[j].volume)) {
+                errors++;
+                threads = j;
+                break;
             }
         }
     }
+    sync();
+
+    for (j = 0; (j < STRATEGIES) && (errors == 0); j++) {
+        if (selected[j]) {
+            current = j;
+            errors += run(out, workers, threads, qthreads, checker);
+        }
+    }
 
-    for (j = 0; j < THREADS; j++) {
-        pthread_join(threads[j], NULL);
-        thread_par_sum += (int)thread_par[j];
+    for (j = 0; j < threads; j++) {
+        unlink(workers[j].disk);
+        unlink(workers[j].volume);
     }
+    free(workers);
+    free(cwd);
+    if (out != stdout)
+        fclose(out);
 
     printf("waited for all competing threads\n");
-    return (0);
+    return (errors);
 }
@@ -91,6 +91,7 @@
 #include "handlers.h"
 #include "server-marshal.h"
 #include <adb-helpers.h>
+#include <trace.h>
 #include "stats.h"
 
 /*----------------------------------------------------------------------------*\
@@ -186,7 +187,7 @@ adb_ncBroadcastNetworkInfoResponse_t *ncBroadcastNetworkInfoMarshal(adb_ncBroadc
     adb_ncBroadcastNetworkInfoType_t *input = NULL;
     adb_ncBroadcastNetworkInfoResponse_t *response = NULL;
     adb_ncBroadcastNetworkInfoResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
     
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -223,7 +224,7 @@ adb_ncBroadcastNetworkInfoResponse_t *ncBroadcastNetworkInfoMarshal(adb_ncBroadc
     }
     pthread_mutex_unlock(&ncHandlerLock);
 
-    nc_update_message_stats("BroadcastNetworkInfo", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("BroadcastNetworkInfo", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -244,7 +245,7 @@ adb_ncAssignAddressResponse_t *ncAssignAddressMarshal(adb_ncAssignAddress_t * nc
     adb_ncAssignAddressType_t *input = NULL;
     adb_ncAssignAddressResponse_t *response = NULL;
     adb_ncAssignAddressResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -283,7 +284,7 @@ adb_ncAssignAddressResponse_t *ncAssignAddressMarshal(adb_ncAssignAddress_t * nc
     }
     pthread_mutex_unlock(&ncHandlerLock);
 
-    nc_update_message_stats("AssignAddress", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("AssignAddress", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -299,7 +300,7 @@ adb_ncPowerDownResponse_t *ncPowerDownMarshal(adb_ncPowerDown_t * ncPowerDown, c
 {
     int error = EUCA_OK;
     ncMetadata meta = { 0 };
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
     adb_ncPowerDownType_t *input = adb_ncPowerDown_get_ncPowerDown(ncPowerDown, env);
     adb_ncPowerDownResponse_t *response = adb_ncPowerDownResponse_create(env);
     adb_ncPowerDownResponseType_t *output = adb_ncPowerDownResponseType_create(env);
@@ -328,7 +329,7 @@ adb_ncPowerDownResponse_t *ncPowerDownMarshal(adb_ncPowerDown_t * ncPowerDown, c
     // set response to output
     adb_ncPowerDownResponse_set_ncPowerDownResponse(response, env, output);
 
-    nc_update_message_stats("PowerDown", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("PowerDown", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -353,7 +354,7 @@ adb_ncStartNetworkResponse_t *ncStartNetworkMarshal(adb_ncStartNetwork_t * ncSta
     adb_ncStartNetworkType_t *input = NULL;
     adb_ncStartNetworkResponse_t *response = NULL;
     adb_ncStartNetworkResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -404,7 +405,7 @@ adb_ncStartNetworkResponse_t *ncStartNetworkMarshal(adb_ncStartNetwork_t * ncSta
     }
     pthread_mutex_unlock(&ncHandlerLock);
 
-    nc_update_message_stats("StartNetwork", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("StartNetwork", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -425,7 +426,7 @@ adb_ncDescribeResourceResponse_t *ncDescribeResourceMarshal(adb_ncDescribeResour
     adb_ncDescribeResourceType_t *input = NULL;
     adb_ncDescribeResourceResponse_t *response = NULL;
     adb_ncDescribeResourceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -468,7 +469,7 @@ adb_ncDescribeResourceResponse_t *ncDescribeResourceMarshal(adb_ncDescribeResour
         adb_ncDescribeResourceResponse_set_ncDescribeResourceResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("DescribeResource", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("DescribeResource", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -513,7 +514,7 @@ adb_ncRunInstanceResponse_t *ncRunInstanceMarshal(adb_ncRunInstance_t * ncRunIns
     adb_ncRunInstanceType_t *input = NULL;
     adb_ncRunInstanceResponse_t *response = NULL;
     adb_ncRunInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -563,9 +564,11 @@ adb_ncRunInstanceResponse_t *ncRunInstanceMarshal(adb_ncRunInstance_t * ncRunIns
             EUCA_MESSAGE_UNMARSHAL(ncRunInstanceType, input, (&meta));
 
             threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+            int span = trace_begin_server("ncRunInstance", meta.correlationId);
             error = doRunInstance(&meta, uuid, instanceId, reservationId, &params, imageId, imageURL, kernelId, kernelURL, ramdiskId, ramdiskURL,
                                   ownerId, accountId, keyName, &netparams, userData, credential, launchIndex, platform, expiryTime, groupNames, groupNamesSize, rootDirective,
                                   &outInst);
+            trace_end(span, (error != EUCA_OK));
             unset_corrid(corr_id);
 
             if (error != EUCA_OK) {
@@ -592,7 +595,7 @@ adb_ncRunInstanceResponse_t *ncRunInstanceMarshal(adb_ncRunInstance_t * ncRunIns
         adb_ncRunInstanceResponse_set_ncRunInstanceResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("RunInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("RunInstance", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -610,14 +613,17 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
     int error = EUCA_OK;
     int instIdsLen = 0;
     int outInstsLen = 0;
+    int unchanged = 0;
     char **instIds = NULL;
+    long long sinceGeneration = 0;
+    long long generation = 0;
     ncMetadata meta = { 0 };
     ncInstance **outInsts = NULL;
     adb_instanceType_t *instance = NULL;
     adb_ncDescribeInstancesType_t *input = NULL;
     adb_ncDescribeInstancesResponse_t *response = NULL;
     adb_ncDescribeInstancesResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
     pthread_mutex_lock(&ncHandlerLock);
     {
         input = adb_ncDescribeInstances_get_ncDescribeInstances(ncDescribeInstances, env);
@@ -633,10 +639,20 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
             for (i = 0; i < instIdsLen; i++) {
                 instIds[i] = adb_ncDescribeInstancesType_get_instanceIds_at(input, env, i);
             }
+            sinceGeneration = adb_ncDescribeInstancesType_get_sinceGeneration(input, env);
 
             // do it
             EUCA_MESSAGE_UNMARSHAL(ncDescribeInstancesType, input, (&meta));
             threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+
+            // read the generation before taking the snapshot, so that any change racing
+            // with this request is reported again on the next one rather than lost
+            generation = get_instances_generation();
+            if ((sinceGeneration < 0) || (sinceGeneration > generation)) {
+                // not a generation of ours (e.g., from before an NC restart), so send everything
+                sinceGeneration = 0;
+            }
+
             if ((error = doDescribeInstances(&meta, instIds, instIdsLen, &outInsts, &outInstsLen)) != EUCA_OK) {
                 LOGERROR("failed error=%d\n", error);
                 adb_ncDescribeInstancesResponseType_set_return(output, env, AXIS2_FALSE);
@@ -646,15 +662,25 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
                 adb_ncDescribeInstancesResponseType_set_correlationId(output, env, meta.correlationId);
                 adb_ncDescribeInstancesResponseType_set_userId(output, env, meta.userId);
 
-                // set operation-specific fields in output
+                // set operation-specific fields in output, instances that have not
+                // changed since the caller's generation are only listed by ID
                 for (i = 0; i < outInstsLen; i++) {
+                    if (sinceGeneration && (outInsts[i]->generation <= sinceGeneration)) {
+                        adb_ncDescribeInstancesResponseType_add_unchangedInstanceIds(output, env, outInsts[i]->instanceId);
+                        release_instance_copy(outInsts[i]);
+                        unchanged++;
+                        continue;
+                    }
+
                     instance = adb_instanceType_create(env);
                     copy_instance_to_adb(instance, env, outInsts[i]);   // copy all values outInst->instance
-                    EUCA_FREE(outInsts[i]);
-
-                    //! @TODO should we free_instance(&outInst) here or not? currently you only have to free outInsts[]
+                    release_instance_copy(outInsts[i]); // the instances are shared with the NC's snapshot
                     adb_ncDescribeInstancesResponseType_add_instances(output, env, instance);
                 }
+                adb_ncDescribeInstancesResponseType_set_generation(output, env, generation);
+                if (sinceGeneration) {
+                    LOGTRACE("delta since generation %lld: %d changed, %d unchanged\n", sinceGeneration, (outInstsLen - unchanged), unchanged);
+                }
 
                 EUCA_FREE(outInsts);
             }
@@ -666,7 +692,7 @@ adb_ncDescribeInstancesResponse_t *ncDescribeInstancesMarshal(adb_ncDescribeInst
         adb_ncDescribeInstancesResponse_set_ncDescribeInstancesResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("DescribeInstances", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("DescribeInstances", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -686,7 +712,7 @@ adb_ncRebootInstanceResponse_t *ncRebootInstanceMarshal(adb_ncRebootInstance_t *
     adb_ncRebootInstanceType_t *input = NULL;
     adb_ncRebootInstanceResponse_t *response = NULL;
     adb_ncRebootInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -719,7 +745,7 @@ adb_ncRebootInstanceResponse_t *ncRebootInstanceMarshal(adb_ncRebootInstance_t *
         adb_ncRebootInstanceResponse_set_ncRebootInstanceResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("RebootInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("RebootInstance", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -740,7 +766,7 @@ adb_ncGetConsoleOutputResponse_t *ncGetConsoleOutputMarshal(adb_ncGetConsoleOutp
     adb_ncGetConsoleOutputType_t *input = NULL;
     adb_ncGetConsoleOutputResponse_t *response = NULL;
     adb_ncGetConsoleOutputResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -775,7 +801,7 @@ adb_ncGetConsoleOutputResponse_t *ncGetConsoleOutputMarshal(adb_ncGetConsoleOutp
         adb_ncGetConsoleOutputResponse_set_ncGetConsoleOutputResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("GetConsoleOutput", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("GetConsoleOutput", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -800,7 +826,7 @@ adb_ncTerminateInstanceResponse_t *ncTerminateInstanceMarshal(adb_ncTerminateIns
     adb_ncTerminateInstanceType_t *input = NULL;
     adb_ncTerminateInstanceResponse_t *response = NULL;
     adb_ncTerminateInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -821,6 +847,7 @@ adb_ncTerminateInstanceResponse_t *ncTerminateInstanceMarshal(adb_ncTerminateIns
         EUCA_MESSAGE_UNMARSHAL(ncTerminateInstanceType, input, (&meta));
 
         threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+        int span = trace_begin_server("ncTerminateInstance", meta.correlationId);
         if ((error = doTerminateInstance(&meta, instanceId, force, &shutdownState, &previousState)) != EUCA_OK) {
             LOGERROR("[%s] failed error=%d\n", instanceId, error);
             adb_ncTerminateInstanceResponseType_set_return(output, env, AXIS2_FALSE);
@@ -844,12 +871,13 @@ adb_ncTerminateInstanceResponse_t *ncTerminateInstanceMarshal(adb_ncTerminateIns
             snprintf(s, 128, "%d", previousState);
             adb_ncTerminateInstanceResponseType_set_previousState(output, env, s);
         }
+        trace_end(span, (error != EUCA_OK));
         unset_corrid(corr_id);
         // set response to output
         adb_ncTerminateInstanceResponse_set_ncTerminateInstanceResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("TerminateInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("TerminateInstance", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -872,7 +900,7 @@ adb_ncAttachVolumeResponse_t *ncAttachVolumeMarshal(adb_ncAttachVolume_t * ncAtt
     adb_ncAttachVolumeType_t *input = NULL;
     adb_ncAttachVolumeResponse_t *response = NULL;
     adb_ncAttachVolumeResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
     pthread_mutex_lock(&ncHandlerLock);
     {
         input = adb_ncAttachVolume_get_ncAttachVolume(ncAttachVolume, env);
@@ -890,6 +918,7 @@ adb_ncAttachVolumeResponse_t *ncAttachVolumeMarshal(adb_ncAttachVolume_t * ncAtt
             EUCA_MESSAGE_UNMARSHAL(ncAttachVolumeType, input, (&meta));
 
             threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+            int span = trace_begin_server("ncAttachVolume", meta.correlationId);
             if ((error = doAttachVolume(&meta, instanceId, volumeId, remoteDev, localDev)) != EUCA_OK) {
                 LOGERROR("[%s][%s] failed error=%d\n", instanceId, volumeId, error);
                 adb_ncAttachVolumeResponseType_set_return(output, env, AXIS2_FALSE);
@@ -902,6 +931,7 @@ adb_ncAttachVolumeResponse_t *ncAttachVolumeMarshal(adb_ncAttachVolume_t * ncAtt
                 adb_ncAttachVolumeResponseType_set_userId(output, env, meta.userId);
                 // no operation-specific fields in output
             }
+            trace_end(span, (error != EUCA_OK));
             unset_corrid(corr_id);
         }
 
@@ -909,7 +939,7 @@ adb_ncAttachVolumeResponse_t *ncAttachVolumeMarshal(adb_ncAttachVolume_t * ncAtt
         adb_ncAttachVolumeResponse_set_ncAttachVolumeResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("AttachVolume", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("AttachVolume", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -934,7 +964,7 @@ adb_ncDetachVolumeResponse_t *ncDetachVolumeMarshal(adb_ncDetachVolume_t * ncDet
     adb_ncDetachVolumeType_t *input = NULL;
     adb_ncDetachVolumeResponse_t *response = NULL;
     adb_ncDetachVolumeResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -958,6 +988,7 @@ adb_ncDetachVolumeResponse_t *ncDetachVolumeMarshal(adb_ncDetachVolume_t * ncDet
         EUCA_MESSAGE_UNMARSHAL(ncDetachVolumeType, input, (&meta));
 
         threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+        int span = trace_begin_server("ncDetachVolume", meta.correlationId);
         if ((error = doDetachVolume(&meta, instanceId, volumeId, remoteDev, localDev, force)) != EUCA_OK) {
             LOGERROR("[%s][%s] failed error=%d\n", instanceId, volumeId, error);
             adb_ncDetachVolumeResponseType_set_return(output, env, AXIS2_FALSE);
@@ -970,12 +1001,13 @@ adb_ncDetachVolumeResponse_t *ncDetachVolumeMarshal(adb_ncDetachVolume_t * ncDet
             adb_ncDetachVolumeResponseType_set_userId(output, env, meta.userId);
             // no operation-specific fields in output
         }
+        trace_end(span, (error != EUCA_OK));
         unset_corrid(corr_id);
         // set response to output
         adb_ncDetachVolumeResponse_set_ncDetachVolumeResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("DetachVolume", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("DetachVolume", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -997,7 +1029,7 @@ adb_ncCreateImageResponse_t *ncCreateImageMarshal(adb_ncCreateImage_t * ncCreate
     adb_ncCreateImageType_t *input = NULL;
     adb_ncCreateImageResponse_t *response = NULL;
     adb_ncCreateImageResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1033,7 +1065,7 @@ adb_ncCreateImageResponse_t *ncCreateImageMarshal(adb_ncCreateImage_t * ncCreate
         adb_ncCreateImageResponse_set_ncCreateImageResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("CreateImage", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("CreateImage", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1062,7 +1094,7 @@ adb_ncBundleInstanceResponse_t *ncBundleInstanceMarshal(adb_ncBundleInstance_t *
     adb_ncBundleInstanceType_t *input = NULL;
     adb_ncBundleInstanceResponse_t *response = NULL;
     adb_ncBundleInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1110,7 +1142,7 @@ adb_ncBundleInstanceResponse_t *ncBundleInstanceMarshal(adb_ncBundleInstance_t *
     }
     pthread_mutex_unlock(&ncHandlerLock);    
     eventlog("NC", userId, correlationId, "BundleInstance", "end");
-    nc_update_message_stats("BundleInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("BundleInstance", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1132,7 +1164,7 @@ adb_ncBundleRestartInstanceResponse_t *ncBundleRestartInstanceMarshal(adb_ncBund
     adb_ncBundleRestartInstanceType_t *input = NULL;
     adb_ncBundleRestartInstanceResponse_t *response = NULL;
     adb_ncBundleRestartInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1171,7 +1203,7 @@ adb_ncBundleRestartInstanceResponse_t *ncBundleRestartInstanceMarshal(adb_ncBund
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", userId, correlationId, "BundleRestartInstance", "end");
-    nc_update_message_stats("BundleRestartInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("BundleRestartInstance", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1193,7 +1225,7 @@ adb_ncCancelBundleTaskResponse_t *ncCancelBundleTaskMarshal(adb_ncCancelBundleTa
     adb_ncCancelBundleTaskType_t *input = NULL;
     adb_ncCancelBundleTaskResponse_t *response = NULL;
     adb_ncCancelBundleTaskResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1235,7 +1267,7 @@ adb_ncCancelBundleTaskResponse_t *ncCancelBundleTaskMarshal(adb_ncCancelBundleTa
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", userId, correlationId, "CancelBundleTask", "end");
-    nc_update_message_stats("CancelBundleTask", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("CancelBundleTask", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1262,7 +1294,7 @@ adb_ncDescribeBundleTasksResponse_t *ncDescribeBundleTasksMarshal(adb_ncDescribe
     adb_ncDescribeBundleTasksType_t *input = NULL;
     adb_ncDescribeBundleTasksResponse_t *response = NULL;
     adb_ncDescribeBundleTasksResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1320,7 +1352,7 @@ adb_ncDescribeBundleTasksResponse_t *ncDescribeBundleTasksMarshal(adb_ncDescribe
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", userId, correlationId, "DescribeBundleTasks", "end");
-    nc_update_message_stats("DescribeBundleTasks", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("DescribeBundleTasks", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1343,15 +1375,17 @@ adb_ncDescribeSensorsResponse_t *ncDescribeSensorsMarshal(adb_ncDescribeSensors_
     long long collectionIntervalTimeMs = 0;
     char **sensorIds = NULL;
     char **instIds = NULL;
+    char *sensorBatch = NULL;
     ncMetadata meta = { 0 };
     axis2_char_t *correlationId = NULL;
     axis2_char_t *userId = NULL;
+    axis2_char_t *sensorCursors = NULL;
     sensorResource **outResources = NULL;
     adb_sensorsResourceType_t *resource = NULL;
     adb_ncDescribeSensorsType_t *input = NULL;
     adb_ncDescribeSensorsResponse_t *response = NULL;
     adb_ncDescribeSensorsResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1387,6 +1421,7 @@ adb_ncDescribeSensorsResponse_t *ncDescribeSensorsMarshal(adb_ncDescribeSensors_
         for (i = 0; i < sensorIdsLen; i++) {
             sensorIds[i] = adb_ncDescribeSensorsType_get_sensorIds_at(input, env, i);
         }
+        sensorCursors = adb_ncDescribeSensorsType_get_sensorCursors(input, env);
 
         // do it
         EUCA_MESSAGE_UNMARSHAL(ncDescribeSensorsType, input, (&meta));
@@ -1402,10 +1437,15 @@ adb_ncDescribeSensorsResponse_t *ncDescribeSensorsMarshal(adb_ncDescribeSensors_
             adb_ncDescribeSensorsResponseType_set_correlationId(output, env, correlationId);
             adb_ncDescribeSensorsResponseType_set_userId(output, env, userId);
 
-            // set operation-specific fields in output
-            for (i = 0; i < outResourcesLen; i++) {
-                resource = copy_sensor_resource_to_adb(env, outResources[i], historySize);
-                adb_ncDescribeSensorsResponseType_add_sensorsResources(output, env, resource);
+            // set operation-specific fields in output, in a batch if the CC sent cursors
+            if ((sensorCursors != NULL) && (sensor_encode_batch(outResources, outResourcesLen, historySize, sensorCursors, &sensorBatch) == EUCA_OK)) {
+                adb_ncDescribeSensorsResponseType_set_sensorBatch(output, env, sensorBatch);
+                EUCA_FREE(sensorBatch);
+            } else {
+                for (i = 0; i < outResourcesLen; i++) {
+                    resource = copy_sensor_resource_to_adb(env, outResources[i], historySize);
+                    adb_ncDescribeSensorsResponseType_add_sensorsResources(output, env, resource);
+                }
             }
         }
 
@@ -1430,7 +1470,7 @@ reply:
         adb_ncDescribeSensorsResponse_set_ncDescribeSensorsResponse(response, env, output);
     }
     pthread_mutex_unlock(&ncHandlerLock);
-    nc_update_message_stats("DescribeSensors", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("DescribeSensors", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1452,7 +1492,7 @@ adb_ncModifyNodeResponse_t *ncModifyNodeMarshal(adb_ncModifyNode_t * ncModifyNod
     adb_ncModifyNodeType_t *input = NULL;
     adb_ncModifyNodeResponse_t *response = NULL;
     adb_ncModifyNodeResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1493,7 +1533,7 @@ adb_ncModifyNodeResponse_t *ncModifyNodeMarshal(adb_ncModifyNode_t * ncModifyNod
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", userId, correlationId, "ModifyNode", "end");
-    nc_update_message_stats("ModifyNode", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("ModifyNode", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1516,7 +1556,7 @@ adb_ncMigrateInstancesResponse_t *ncMigrateInstancesMarshal(adb_ncMigrateInstanc
     adb_ncMigrateInstancesType_t *input = NULL;
     adb_ncMigrateInstancesResponse_t *response = NULL;
     adb_ncMigrateInstancesResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1580,7 +1620,7 @@ mi_error:
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", meta.userId, meta.correlationId, "MigrateInstances", "end");
-    nc_update_message_stats("MigrateInstances", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("MigrateInstances", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1602,7 +1642,7 @@ adb_ncStartInstanceResponse_t *ncStartInstanceMarshal(adb_ncStartInstance_t * nc
     adb_ncStartInstanceType_t *input = NULL;
     adb_ncStartInstanceResponse_t *response = NULL;
     adb_ncStartInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1644,7 +1684,7 @@ adb_ncStartInstanceResponse_t *ncStartInstanceMarshal(adb_ncStartInstance_t * nc
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", userId, correlationId, "StartInstance", "end");
-    nc_update_message_stats("StartInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("StartInstance", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
@@ -1666,7 +1706,7 @@ adb_ncStopInstanceResponse_t *ncStopInstanceMarshal(adb_ncStopInstance_t * ncSto
     adb_ncStopInstanceType_t *input = NULL;
     adb_ncStopInstanceResponse_t *response = NULL;
     adb_ncStopInstanceResponseType_t *output = NULL;
-    long long call_time = time_ms();
+    long long call_time = mono_time_ms();
 
     pthread_mutex_lock(&ncHandlerLock);
     {
@@ -1708,7 +1748,153 @@ adb_ncStopInstanceResponse_t *ncStopInstanceMarshal(adb_ncStopInstance_t * ncSto
     pthread_mutex_unlock(&ncHandlerLock);
 
     eventlog("NC", userId, correlationId, "StopInstance", "end");
-    nc_update_message_stats("StopInstance", (long)(time_ms() - call_time), error);
+    nc_update_message_stats("StopInstance", (long)(mono_time_ms() - call_time), error);
+    return (response);
+}
+
+//!
+//! Unmarshals, executes, responds to the request to terminate a list of instances.
+//!
+//! @param[in] ncTerminateInstances a pointer to the request parameters
+//! @param[in] env pointer to the AXIS2 environment structure
+//!
+//! @return a pointer to the request's response structure, which lists the instances that failed
+//!
+adb_ncTerminateInstancesResponse_t *ncTerminateInstancesMarshal(adb_ncTerminateInstances_t * ncTerminateInstances, const axutil_env_t * env)
+{
+    int i = 0;
+    int error = EUCA_OK;
+    int instIdsLen = 0;
+    int *outStatus = NULL;
+    char **instIds = NULL;
+    boolean force = FALSE;
+    ncMetadata meta = { 0 };
+    adb_ncTerminateInstancesType_t *input = NULL;
+    adb_ncTerminateInstancesResponse_t *response = NULL;
+    adb_ncTerminateInstancesResponseType_t *output = NULL;
+    long long call_time = mono_time_ms();
+
+    pthread_mutex_lock(&ncHandlerLock);
+    {
+        input = adb_ncTerminateInstances_get_ncTerminateInstances(ncTerminateInstances, env);
+        response = adb_ncTerminateInstancesResponse_create(env);
+        output = adb_ncTerminateInstancesResponseType_create(env);
+
+        // get operation-specific fields from input
+        instIdsLen = adb_ncTerminateInstancesType_sizeof_instanceIds(input, env);
+        if (((instIds = EUCA_ZALLOC(instIdsLen, sizeof(char *))) == NULL) || ((outStatus = EUCA_ZALLOC(instIdsLen, sizeof(int))) == NULL)) {
+            LOGERROR("out of memory\n");
+            error = EUCA_MEMORY_ERROR;
+            adb_ncTerminateInstancesResponseType_set_return(output, env, AXIS2_FALSE);
+        } else {
+            for (i = 0; i < instIdsLen; i++) {
+                instIds[i] = adb_ncTerminateInstancesType_get_instanceIds_at(input, env, i);
+            }
+            force = ((adb_ncTerminateInstancesType_get_force(input, env) == AXIS2_TRUE) ? TRUE : FALSE);
+
+            // do it
+            EUCA_MESSAGE_UNMARSHAL(ncTerminateInstancesType, input, (&meta));
+
+            threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+            int span = trace_begin_server("ncTerminateInstances", meta.correlationId);
+            if ((error = doTerminateInstances(&meta, instIds, instIdsLen, force, outStatus)) != EUCA_OK) {
+                LOGERROR("failed error=%d\n", error);
+                adb_ncTerminateInstancesResponseType_set_return(output, env, AXIS2_FALSE);
+            } else {
+                // set standard fields in output
+                adb_ncTerminateInstancesResponseType_set_return(output, env, AXIS2_TRUE);
+                adb_ncTerminateInstancesResponseType_set_correlationId(output, env, meta.correlationId);
+                adb_ncTerminateInstancesResponseType_set_userId(output, env, meta.userId);
+
+                // set operation-specific fields in output
+                for (i = 0; i < instIdsLen; i++) {
+                    if (outStatus[i])
+                        adb_ncTerminateInstancesResponseType_add_failedInstanceIds(output, env, instIds[i]);
+                }
+            }
+            trace_end(span, (error != EUCA_OK));
+            unset_corrid(corr_id);
+        }
+        EUCA_FREE(instIds);
+        EUCA_FREE(outStatus);
+
+        // set response to output
+        adb_ncTerminateInstancesResponse_set_ncTerminateInstancesResponse(response, env, output);
+    }
+    pthread_mutex_unlock(&ncHandlerLock);
+    nc_update_message_stats("TerminateInstances", (long)(mono_time_ms() - call_time), error);
+    return (response);
+}
+
+//!
+//! Unmarshals, executes, responds to the request to reboot a list of instances.
+//!
+//! @param[in] ncRebootInstances a pointer to the request parameters
+//! @param[in] env pointer to the AXIS2 environment structure
+//!
+//! @return a pointer to the request's response structure, which lists the instances that failed
+//!
+adb_ncRebootInstancesResponse_t *ncRebootInstancesMarshal(adb_ncRebootInstances_t * ncRebootInstances, const axutil_env_t * env)
+{
+    int i = 0;
+    int error = EUCA_OK;
+    int instIdsLen = 0;
+    int *outStatus = NULL;
+    char **instIds = NULL;
+    ncMetadata meta = { 0 };
+    adb_ncRebootInstancesType_t *input = NULL;
+    adb_ncRebootInstancesResponse_t *response = NULL;
+    adb_ncRebootInstancesResponseType_t *output = NULL;
+    long long call_time = mono_time_ms();
+
+    pthread_mutex_lock(&ncHandlerLock);
+    {
+        input = adb_ncRebootInstances_get_ncRebootInstances(ncRebootInstances, env);
+        response = adb_ncRebootInstancesResponse_create(env);
+        output = adb_ncRebootInstancesResponseType_create(env);
+
+        // get operation-specific fields from input
+        instIdsLen = adb_ncRebootInstancesType_sizeof_instanceIds(input, env);
+        if (((instIds = EUCA_ZALLOC(instIdsLen, sizeof(char *))) == NULL) || ((outStatus = EUCA_ZALLOC(instIdsLen, sizeof(int))) == NULL)) {
+            LOGERROR("out of memory\n");
+            error = EUCA_MEMORY_ERROR;
+            adb_ncRebootInstancesResponseType_set_return(output, env, AXIS2_FALSE);
+        } else {
+            for (i = 0; i < instIdsLen; i++) {
+                instIds[i] = adb_ncRebootInstancesType_get_instanceIds_at(input, env, i);
+            }
+
+            // do it
+            EUCA_MESSAGE_UNMARSHAL(ncRebootInstancesType, input, (&meta));
+
+            threadCorrelationId *corr_id = set_corrid(meta.correlationId);
+            int span = trace_begin_server("ncRebootInstances", meta.correlationId);
+            if ((error = doRebootInstances(&meta, instIds, instIdsLen, outStatus)) != EUCA_OK) {
+                LOGERROR("failed error=%d\n", error);
+                adb_ncRebootInstancesResponseType_set_return(output, env, AXIS2_FALSE);
+            } else {
+                // set standard fields in output
+                adb_ncRebootInstancesResponseType_set_return(output, env, AXIS2_TRUE);
+                adb_ncRebootInstancesResponseType_set_correlationId(output, env, meta.correlationId);
+                adb_ncRebootInstancesResponseType_set_userId(output, env, meta.userId);
+
+                // set operation-specific fields in output
+                for (i = 0; i < instIdsLen; i++) {
+                    if (outStatus[i])
+                        adb_ncRebootInstancesResponseType_add_failedInstanceIds(output, env, instIds[i]);
+                }
+            }
+            trace_end(span, (error != EUCA_OK));
+            unset_corrid(corr_id);
+        }
+        EUCA_FREE(instIds);
+        EUCA_FREE(outStatus);
+
+        // set response to output
+        adb_ncRebootInstancesResponse_set_ncRebootInstancesResponse(response, env, output);
+    }
+    pthread_mutex_unlock(&ncHandlerLock);
+    nc_update_message_stats("RebootInstances", (long)(mono_time_ms() - call_time), error);
     return (response);
 }
 
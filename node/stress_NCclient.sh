@@ -58,6 +58,8 @@
 #   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
 #   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
 
+# functional smoke test only, for throughput and latencies under load see NCload -h
+
 CL=./NCclient
 WS=localhost:9090
 RU=runInstance
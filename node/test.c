@@ -267,6 +267,28 @@ int main(int argc, char **argv)
         assert(n == EUCA_OK);
         n = total_instances(&bag);
         assert(n == INSTS - 2);
+        assert(find_instance(&bag, "i-0") == NULL);
+        assert(find_instance(&bag, "i-1") == Insts[1]);
+        assert(find_instance(&bag, "i-25") == Insts[25]);
+        n = add_instance(&bag, Insts[25]);
+        assert(n == EUCA_DUPLICATE_ERROR);
+        n = remove_instance(&bag, Insts[0]);
+        assert(n == EUCA_NOT_FOUND_ERROR);
+        n = add_instance(&bag, Insts[0]);
+        assert(n == EUCA_OK);
+        assert(bag->instance == Insts[1]);
+        assert(bag->last->instance == Insts[0]);
+        for (i = 1; i < INSTS - 1; i++) {
+            n = remove_instance(&bag, Insts[i]);
+            assert(n == EUCA_OK);
+        }
+        assert(total_instances(&bag) == 1);
+        assert(find_instance(&bag, "i-0") == Insts[0]);
+        n = remove_instance(&bag, Insts[0]);
+        assert(n == EUCA_OK);
+        assert(bag == NULL);
+        for (i = 0; i < INSTS; i++)
+            free_instance(&Insts[i]);
 
         printf("========> testing volume struct management\n");
         ncVolume *v;
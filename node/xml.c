@@ -84,6 +84,7 @@
 #include <sys/types.h>                 // umask
 #include <sys/stat.h>                  // umask
 #include <pthread.h>
+#include <unistd.h>                    // unlink
 #include <libxml/xmlmemory.h>
 #include <libxml/debugXML.h>
 #include <libxml/HTMLtree.h>
@@ -112,6 +113,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define XML_DOC_CACHE_SIZE                       32 //!< Number of parsed XML documents kept for the get_xpath_* functions
+#define XPATH_CACHE_SIZE                        128 //!< Number of compiled XPath expressions kept for the get_xpath_* functions
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -130,6 +134,21 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Parsed XML document kept by the get_xpath_* functions, reused while the file stays the same
+typedef struct xml_doc_cache_t {
+    char path[EUCA_MAX_PATH];          //!< path of the parsed file
+    struct stat st;                    //!< state of the file when it was parsed
+    xmlDocPtr doc;                     //!< the parsed document, or NULL if the slot is free
+    unsigned long used;                //!< value of xml_cache_clock at the last lookup, for LRU eviction
+} xml_doc_cache;
+
+//! Compiled XPath expression kept by the get_xpath_* functions
+typedef struct xpath_cache_t {
+    char *expr;                        //!< the source expression (malloc'ed)
+    xmlXPathCompExprPtr comp;          //!< the compiled expression, or NULL if the slot is free
+    unsigned long used;                //!< value of xml_cache_clock at the last lookup, for LRU eviction
+} xpath_cache;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -155,9 +174,26 @@ static char nc_home[EUCA_MAX_PATH] = "";    //!< Base of the NC installation ("/
 static boolean config_use_virtio_root = 0;  //!< Set to TRUE if we are using VIRTIO root
 static boolean config_use_virtio_disk = 0;  //!< Set to TRUE if we are using VIRTIO disks
 static boolean config_use_virtio_net = 0;   //!< Set to TRUE if we are using VIRTIO network
+static boolean config_reclaim_sparse_blocks = 0;    //!< Set to TRUE if guests may discard blocks of their disks
+static int config_virtio_net_queues = 0;    //!< Most queues per virtio NIC
+static int config_virtio_net_ring_size = 0; //!< Size of the receive ring of each virtio NIC queue, or 0 for the default
+static int config_virtio_iothreads = 0;     //!< Number of I/O threads for virtio disks, or 0 for none
+static char config_virtio_tuned_vm_types[CHAR_BUFFER_SIZE] = "";    //!< VM types the virtio tuning applies to, or empty for all
+static int config_balloon_stats_period = 0; //!< Seconds between the memory statistics updates of the virtio balloon, or 0 for none
+static qosProfile config_qos_profiles[MAX_QOS_PROFILES] = { {{0}} };   //!< QoS profiles set from INSTANCE_QOS, guarded by xml_mutex
+static int config_qos_profiles_len = 0;     //!< Number of profiles in config_qos_profiles
 static char xslt_path[EUCA_MAX_PATH] = "";  //!< Destination path for the XSLT files
 static pthread_mutex_t xml_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< process-global mutex
 
+static xsltStylesheetPtr xslt_cached = NULL;    //!< compiled stylesheet kept by get_xslt_stylesheet(), guarded by xml_mutex
+static char xslt_cached_path[EUCA_MAX_PATH] = "";   //!< path of the cached stylesheet
+static struct stat xslt_cached_stat = { 0 };    //!< state of the stylesheet file when it was compiled
+
+static pthread_rwlock_t xml_cache_lock = PTHREAD_RWLOCK_INITIALIZER;    //!< guards the two caches below: queries share it, misses take it exclusively
+static xml_doc_cache xml_doc_cached[XML_DOC_CACHE_SIZE] = { {{0}} };    //!< parsed documents for the get_xpath_* functions
+static xpath_cache xpath_cached[XPATH_CACHE_SIZE] = { {0} };    //!< compiled expressions for the get_xpath_* functions
+static unsigned long xml_cache_clock = 0;   //!< lookup counter, incremented atomically since readers run concurrently
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -174,10 +210,20 @@ static void cleanup(void);
 static int path_check(const char *path, const char *name);
 static int write_xml_file(const xmlDocPtr doc, const char *instanceId, const char *path, const char *type);
 static void write_vbr_xml(xmlNodePtr vbrs, const virtualBootRecord * vbr);
+static boolean vm_type_tuned(const char *vm_type);
+static const qosProfile *find_qos_profile(const char *vm_type);
+static void write_qos_xml(xmlNodePtr parent, const qosProfile * profile);
 
 static void error_handler(void *ctx, const char *fmt, ...) _attribute_format_(2, 3);
+static xsltStylesheetPtr get_xslt_stylesheet(const char *xsltStylesheetPath);
 static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inputXmlPath, const char *outputXmlPath, char *outputXmlBuffer, int outputXmlBufferSize);
 
+static xml_doc_cache *find_xml_doc(const char *xml_path, const struct stat *st);
+static xml_doc_cache *load_xml_doc(const char *xml_path, const struct stat *st);
+static xpath_cache *find_xpath(const char *xpath);
+static xpath_cache *compile_xpath(const char *xpath);
+static xmlXPathObjectPtr eval_cached_xpath(const char *xml_path, const char *xpath, xmlDocPtr * pdoc);
+
 #ifdef __STANDALONE
 static void create_dummy_instance(const char *file);
 int main(int argc, char **argv);
@@ -305,6 +351,12 @@ static void init_xml(struct nc_state_t *nc_state)
                 config_use_virtio_root = nc_state->config_use_virtio_root;
                 config_use_virtio_disk = nc_state->config_use_virtio_disk;
                 config_use_virtio_net = nc_state->config_use_virtio_net;
+                config_reclaim_sparse_blocks = nc_state->reclaim_sparse_blocks;
+                config_virtio_net_queues = nc_state->config_virtio_net_queues;
+                config_virtio_net_ring_size = nc_state->config_virtio_net_ring_size;
+                config_virtio_iothreads = nc_state->config_virtio_iothreads;
+                euca_strncpy(config_virtio_tuned_vm_types, nc_state->config_virtio_tuned_vm_types, sizeof(config_virtio_tuned_vm_types));
+                config_balloon_stats_period = nc_state->config_balloon_stats_period;
                 euca_strncpy(xslt_path, nc_state->libvirt_xslt_path, sizeof(xslt_path));
             }
             initialized = TRUE;
@@ -354,13 +406,24 @@ static int path_check(const char *path, const char *name)
 static int write_xml_file(const xmlDocPtr doc, const char *instanceId, const char *path, const char *type)
 {
     int ret = 0;
+    char tmp_path[EUCA_MAX_PATH] = "";
     mode_t old_umask = umask(~BACKING_FILE_PERM);   // ensure the generated XML file has the right perms
 
-    chmod(path, BACKING_FILE_PERM);    // ensure perms in case when XML file exists
-    if ((ret = xmlSaveFormatFileEnc(path, doc, "UTF-8", 1)) > 0) {
-        LOGTRACE("[%s] wrote %s XML to %s\n", instanceId, type, path);
+    // write a new file and rename it over the old one, so that readers, and the NC after a
+    // crash, never see a partially written file
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ((ret = xmlSaveFormatFileEnc(tmp_path, doc, "UTF-8", 1)) > 0) {
+        chmod(tmp_path, BACKING_FILE_PERM);
+        if (rename(tmp_path, path) == 0) {
+            LOGTRACE("[%s] wrote %s XML to %s\n", instanceId, type, path);
+        } else {
+            LOGERROR("[%s] failed to rename %s XML to %s: %s\n", instanceId, type, path, strerror(errno));
+            unlink(tmp_path);
+            ret = -1;
+        }
     } else {
         LOGERROR("[%s] failed to write %s XML to %s\n", instanceId, type, path);
+        unlink(tmp_path);
     }
     umask(old_umask);
     return ((ret > 0) ? (EUCA_OK) : (EUCA_ERROR));
@@ -433,6 +496,147 @@ int read_nc_xml(struct nc_state_t *nc_state_param)
     return (EUCA_OK);
 }
 
+//!
+//! Tells whether the virtio queue and I/O thread settings apply to instances of a VM type
+//!
+//! @param[in] vm_type name of the VM type, e.g., "m1.small"
+//!
+//! @return TRUE if VIRTIO_TUNED_VM_TYPES is empty or lists the VM type, FALSE otherwise
+//!
+static boolean vm_type_tuned(const char *vm_type)
+{
+    const char *p = config_virtio_tuned_vm_types;
+    size_t len = strlen(vm_type);
+
+    if (strspn(p, " \t,") == strlen(p))
+        return (TRUE);
+
+    while ((p = strstr(p, vm_type)) != NULL) {
+        if (((p == config_virtio_tuned_vm_types) || strchr(" \t,", p[-1])) && ((p[len] == '\0') || strchr(" \t,", p[len])))
+            return (TRUE);
+        p += len;
+    }
+    return (FALSE);
+}
+
+//!
+//! Sets the disk and network caps of the VM types from the value of INSTANCE_QOS, a list of
+//! space-separated "vmtype:diskIops:diskBytesPerSec:netInKBs:netOutKBs" entries where a 0 or a
+//! missing trailing field means no cap and the "*" VM type applies to the VM types not listed.
+//!
+//! @param[in] spec the list of profiles, NULL or empty for none
+//!
+//! @return the number of profiles set or -1 if the list is malformed, in which case the
+//!         profiles are left unchanged
+//!
+int set_qos_profiles(const char *spec)
+{
+    int len = 0;
+    int fields = 0;
+    char *entry = NULL;
+    char *saveptr = NULL;
+    char *copy = NULL;
+    qosProfile profiles[MAX_QOS_PROFILES] = { {{0}} };
+
+    if (spec && strlen(spec)) {
+        if ((copy = strdup(spec)) == NULL)
+            return (-1);
+
+        for (entry = strtok_r(copy, " \t,", &saveptr); entry; entry = strtok_r(NULL, " \t,", &saveptr)) {
+            if (len == MAX_QOS_PROFILES) {
+                LOGERROR("more than %d profiles in '%s'\n", MAX_QOS_PROFILES, spec);
+                EUCA_FREE(copy);
+                return (-1);
+            }
+
+            fields = sscanf(entry, "%63[^:]:%lld:%lld:%lld:%lld", profiles[len].vmType, &profiles[len].diskIops, &profiles[len].diskBytes, &profiles[len].netInKBs,
+                            &profiles[len].netOutKBs);
+            if ((fields < 2) || (profiles[len].diskIops < 0) || (profiles[len].diskBytes < 0) || (profiles[len].netInKBs < 0) || (profiles[len].netOutKBs < 0)) {
+                LOGERROR("malformed QoS profile '%s', expected vmtype:diskIops[:diskBytesPerSec[:netInKBs[:netOutKBs]]]\n", entry);
+                EUCA_FREE(copy);
+                return (-1);
+            }
+            len++;
+        }
+        EUCA_FREE(copy);
+    }
+
+    pthread_mutex_lock(&xml_mutex);
+    {
+        memcpy(config_qos_profiles, profiles, sizeof(config_qos_profiles));
+        config_qos_profiles_len = len;
+    }
+    pthread_mutex_unlock(&xml_mutex);
+    return (len);
+}
+
+//!
+//! Looks up the QoS profile of a VM type, to be called with xml_mutex held
+//!
+//! @param[in] vm_type name of the VM type, e.g., "m1.small"
+//!
+//! @return a pointer to the profile of the VM type, else to the "*" one, or NULL if neither is set
+//!
+static const qosProfile *find_qos_profile(const char *vm_type)
+{
+    int i = 0;
+    const qosProfile *pDefault = NULL;
+
+    for (i = 0; i < config_qos_profiles_len; i++) {
+        if (vm_type && !strcmp(config_qos_profiles[i].vmType, vm_type))
+            return (&config_qos_profiles[i]);
+        if (!strcmp(config_qos_profiles[i].vmType, "*"))
+            pDefault = &config_qos_profiles[i];
+    }
+    return (pDefault);
+}
+
+//!
+//! Gets the QoS profile that applies to the instances of a VM type
+//!
+//! @param[in]  vm_type name of the VM type, e.g., "m1.small"
+//! @param[out] profile set to the profile of the VM type
+//!
+//! @return TRUE if a profile applies to the VM type, FALSE otherwise
+//!
+boolean get_qos_profile(const char *vm_type, qosProfile * profile)
+{
+    boolean found = FALSE;
+    const qosProfile *pProfile = NULL;
+
+    pthread_mutex_lock(&xml_mutex);
+    {
+        if ((pProfile = find_qos_profile(vm_type)) != NULL) {
+            if (profile)
+                *profile = *pProfile;
+            found = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&xml_mutex);
+    return (found);
+}
+
+//!
+//! Writes the caps of a QoS profile to an xml node
+//!
+//! @param[in] parent pointer to the instance or volume XML node
+//! @param[in] profile pointer to the profile
+//!
+static void write_qos_xml(xmlNodePtr parent, const qosProfile * profile)
+{
+    char num_s[32] = "";
+    xmlNodePtr qos = _NODE(parent, "qos");
+
+    snprintf(num_s, sizeof(num_s), "%lld", profile->diskIops);
+    _ATTRIBUTE(qos, "diskIops", num_s);
+    snprintf(num_s, sizeof(num_s), "%lld", profile->diskBytes);
+    _ATTRIBUTE(qos, "diskBytes", num_s);
+    snprintf(num_s, sizeof(num_s), "%lld", profile->netInKBs);
+    _ATTRIBUTE(qos, "netInbound", num_s);
+    snprintf(num_s, sizeof(num_s), "%lld", profile->netOutKBs);
+    _ATTRIBUTE(qos, "netOutbound", num_s);
+}
+
 //!
 //! Writes VBR information to xml node
 //!
@@ -473,6 +677,8 @@ static void write_vbr_xml(xmlNodePtr vbrs, const virtualBootRecord * vbr)
     _ELEMENT(node, "backingType", libvirtSourceTypeNames[vbr->backingType]);
     _ELEMENT(node, "backingPath", vbr->backingPath);
     _ELEMENT(node, "preparedResourceLocation", vbr->preparedResourceLocation);
+    if (strlen(vbr->backingFormat))
+        _ELEMENT(node, "backingFormat", vbr->backingFormat);
 }
 
 //!
@@ -496,6 +702,7 @@ int gen_instance_xml(const ncInstance * instance)
     char cores_s[10] = "";
     char memory_s[10] = "";
     char disk_s[10] = "";
+    char num_s[16] = "";
     char bitness[4] = "";
     char root_uuid[64] = "";
     char devstr[SMALL_CHAR_BUFFER_SIZE] = "";
@@ -507,6 +714,9 @@ int gen_instance_xml(const ncInstance * instance)
     xmlNodePtr root = NULL;
     xmlNodePtr key = NULL;
     xmlNodePtr os = NULL;
+    xmlNodePtr numa = NULL;
+    xmlNodePtr tuning = NULL;
+    const qosProfile *qos = NULL;
     xmlNodePtr groupNames = NULL;
     xmlNodePtr disks = NULL;
     xmlNodePtr vbrs = NULL;
@@ -585,6 +795,23 @@ int gen_instance_xml(const ncInstance * instance)
         _ELEMENT(instanceNode, "NicDevice", instance->params.guestNicDeviceName);
         _ELEMENT(instanceNode, "rootDirective", instance->rootDirective);
 
+        // NUMA placement and huge pages, if any
+        if (instance->numaPinned) {
+            numa = _NODE(instanceNode, "numa");
+            snprintf(num_s, sizeof(num_s), "%d", instance->numaNode);
+            _ATTRIBUTE(numa, "node", num_s);
+            _ATTRIBUTE(numa, "cpus", instance->numaCpus);
+        }
+        if (instance->hugePagesKB > 0) {
+            snprintf(num_s, sizeof(num_s), "%d", instance->hugePagesKB);
+            _ELEMENT(instanceNode, "hugePagesKB", num_s);
+        }
+        // memory statistics of the guest, for the memory density mode
+        if (config_balloon_stats_period > 0) {
+            snprintf(num_s, sizeof(num_s), "%d", config_balloon_stats_period);
+            _ELEMENT(instanceNode, "balloonStatsPeriod", num_s);
+        }
+
         // SSH-key related
         key = _NODE(instanceNode, "key");
         _ATTRIBUTE(key, "doInjectKey", _BOOL(instance->do_inject_key));
@@ -597,6 +824,21 @@ int gen_instance_xml(const ncInstance * instance)
         _ATTRIBUTE(os, "virtioDisk", _BOOL(config_use_virtio_disk));
         _ATTRIBUTE(os, "virtioNetwork", _BOOL(config_use_virtio_net));
 
+        // virtio queues and I/O threads, for the VM types they apply to
+        if ((strlen(instance->params.name) > 0) && vm_type_tuned(instance->params.name)) {
+            tuning = _NODE(instanceNode, "virtioTuning");
+            snprintf(num_s, sizeof(num_s), "%d", ((config_virtio_net_queues < instance->params.cores) ? config_virtio_net_queues : instance->params.cores));
+            _ATTRIBUTE(tuning, "netQueues", num_s);
+            snprintf(num_s, sizeof(num_s), "%d", config_virtio_net_ring_size);
+            _ATTRIBUTE(tuning, "netRingSize", num_s);
+            snprintf(num_s, sizeof(num_s), "%d", config_virtio_iothreads);
+            _ATTRIBUTE(tuning, "ioThreads", num_s);
+        }
+        // disk and network caps, for the VM types with a QoS profile
+        if ((qos = find_qos_profile(instance->params.name)) != NULL) {
+            write_qos_xml(instanceNode, qos);
+        }
+
         // Network groups assigned to the instance
         groupNames = _NODE(instanceNode, "groupNames");
         for (i = 0; i < instance->groupNamesSize; i++) {
@@ -605,6 +847,7 @@ int gen_instance_xml(const ncInstance * instance)
 
         // disks specification
         disks = _NODE(instanceNode, "disks");
+        _ATTRIBUTE(disks, "discard", _BOOL(config_reclaim_sparse_blocks));
         _ELEMENT(disks, "floppyPath", instance->floppyFilePath);
 
         vbrs = _NODE(instanceNode, "vbrs");
@@ -660,6 +903,8 @@ int gen_instance_xml(const ncInstance * instance)
                 }
                 _ATTRIBUTE(disk, "targetDeviceBus", libvirtBusTypeNames[vbr->guestDeviceBus]);
                 _ATTRIBUTE(disk, "sourceType", libvirtSourceTypeNames[vbr->backingType]);
+                if (strlen(vbr->backingFormat))
+                    _ATTRIBUTE(disk, "format", vbr->backingFormat);
 
                 if (j) {
                     rootNode = _ELEMENT(disks, "root", NULL);
@@ -890,6 +1135,21 @@ int read_instance_xml(const char *xml_path, ncInstance * instance)
     XGET_ENUM("/instance/NicType", instance->params.nicType, libvirtNicType_from_string);
     XGET_STR("/instance/NicDevice", instance->params.guestNicDeviceName);
     XGET_STR("/instance/rootDirective", instance->rootDirective);
+
+    // NUMA placement and huge pages are absent from records of unpinned instances and of older NCs
+    {
+        char numa_s[16] = "";
+
+        instance->numaPinned = FALSE;
+        if (get_xpath_content_at(xml_path, "/instance/numa/@node", 0, numa_s, sizeof(numa_s)) != NULL) {
+            instance->numaPinned = TRUE;
+            instance->numaNode = atoi(numa_s);
+            XGET_STR("/instance/numa/@cpus", instance->numaCpus);
+        }
+        instance->hugePagesKB = 0;
+        if (get_xpath_content_at(xml_path, "/instance/hugePagesKB", 0, numa_s, sizeof(numa_s)) != NULL)
+            instance->hugePagesKB = atoi(numa_s);
+    }
     XGET_BOOL("/instance/key/@doInjectKey", instance->do_inject_key);
     XGET_STR("/instance/key/@sshKey", instance->keyName);
     XGET_STR("/instance/os/@platform", instance->platform);
@@ -964,6 +1224,9 @@ int read_instance_xml(const char *xml_path, ncInstance * instance)
             XGET_STR_FREE(vbrxpath, vbr->backingPath);
             MKVBRPATH("preparedResourceLocation");
             XGET_STR_FREE(vbrxpath, vbr->preparedResourceLocation);
+            MKVBRPATH("backingFormat"); // only disks that are not raw have it
+            if (get_xpath_content_at(xml_path, vbrxpath, 0, vbr->backingFormat, sizeof(vbr->backingFormat)) == NULL)
+                vbr->backingFormat[0] = '\0';
 
             // set pointers in the VBR
             if (strcmp(vbr->typeName, "machine") == 0 || (strcmp(vbr->typeName, "ebs") == 0 && vbr->diskNumber == 0 && vbr->partitionNumber == 0)) {
@@ -1117,9 +1380,48 @@ static void error_handler(void *ctx, const char *fmt, ...)
     }
 }
 
+//!
+//! Returns the compiled form of an XSL-T stylesheet. The stylesheet is only parsed on first use
+//! and again once its file is replaced or modified, so that edits of, e.g., libvirt.xsl by an
+//! operator take effect on the next launch or attachment without restarting the NC. Must be
+//! called with xml_mutex held, and the result must not be freed.
+//!
+//! @param[in] xsltStylesheetPath a string containing the path to the XSLT Stylesheet
+//!
+//! @return the compiled stylesheet or NULL if it could not be parsed
+//!
+static xsltStylesheetPtr get_xslt_stylesheet(const char *xsltStylesheetPath)
+{
+    struct stat st = { 0 };
+    xsltStylesheetPtr cur = NULL;
+
+    if (stat(xsltStylesheetPath, &st) != 0) {
+        LOGERROR("failed to stat XSL-T stylesheet file %s\n", xsltStylesheetPath);
+        return (NULL);
+    }
+
+    if (xslt_cached && !strcmp(xslt_cached_path, xsltStylesheetPath) && (st.st_ino == xslt_cached_stat.st_ino)
+        && (st.st_size == xslt_cached_stat.st_size) && (st.st_mtime == xslt_cached_stat.st_mtime)) {
+        return (xslt_cached);
+    }
+
+    if ((cur = xsltParseStylesheetFile((const xmlChar *)xsltStylesheetPath)) == NULL)
+        return (NULL);
+
+    if (xslt_cached) {
+        LOGINFO("XSL-T stylesheet file %s changed, using the new version\n", xsltStylesheetPath);
+        xsltFreeStylesheet(xslt_cached);
+    }
+    xslt_cached = cur;
+    euca_strncpy(xslt_cached_path, xsltStylesheetPath, sizeof(xslt_cached_path));
+    xslt_cached_stat = st;
+    return (cur);
+}
+
 //!
 //! Processes input XML file (e.g., instance metadata) into output XML file or string (e.g., for libvirt)
-//! using XSL-T specification file (e.g., libvirt.xsl)
+//! using XSL-T specification file (e.g., libvirt.xsl), whose compiled form is cached by
+//! get_xslt_stylesheet()
 //!
 //! @param[in]  xsltStylesheetPath a string containing the path to the XSLT Stylesheet
 //! @param[in]  inputXmlPath a string containing the path of the input XML document
@@ -1146,7 +1448,7 @@ static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inp
     xmlDocPtr res = NULL;
 
     INIT();
-    if ((cur = xsltParseStylesheetFile((const xmlChar *)xsltStylesheetPath)) != NULL) {
+    if ((cur = get_xslt_stylesheet(xsltStylesheetPath)) != NULL) {
         if ((doc = xmlParseFile(inputXmlPath)) != NULL) {
             ctxt = xsltNewTransformContext(cur, doc);   // need context to get result
             xsltSetCtxtParseOptions(ctxt, 0);   //! @todo do we want any XSL-T parsing options?
@@ -1201,7 +1503,6 @@ static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inp
             LOGERROR("failed to parse XML document %s\n", inputXmlPath);
             err = EUCA_ERROR;
         }
-        xsltFreeStylesheet(cur);
     } else {
         LOGERROR("failed to open and parse XSL-T stylesheet file %s\n", xsltStylesheetPath);
         err = EUCA_IO_ERROR;
@@ -1233,6 +1534,7 @@ int gen_volume_xml(const char *volumeId, const ncInstance * instance, const char
     xmlNodePtr backing = NULL;
     xmlNodePtr root = NULL;
     xmlNodePtr disk = NULL;
+    const qosProfile *qos = NULL;
 
     INIT();
 
@@ -1260,6 +1562,10 @@ int gen_volume_xml(const char *volumeId, const ncInstance * instance, const char
         _ATTRIBUTE(os, "virtioDisk", _BOOL(config_use_virtio_disk));
         _ATTRIBUTE(os, "virtioNetwork", _BOOL(config_use_virtio_net));
 
+        // disk caps, for the VM types with a QoS profile
+        if ((qos = find_qos_profile(instance->params.name)) != NULL) {
+            write_qos_xml(volumeNode, qos);
+        }
         //! backing specification (@todo maybe expand this with device maps or whatnot?)
         backing = xmlNewChild(volumeNode, NULL, BAD_CAST "backing", NULL);
         root = xmlNewChild(backing, NULL, BAD_CAST "root", NULL);
@@ -1314,6 +1620,190 @@ int gen_libvirt_volume_xml(const char *volumeId, const ncInstance * instance)
     return (ret);
 }
 
+//!
+//! Looks up the parsed document for a file in the document cache. Must be called
+//! with xml_cache_lock held, in either mode.
+//!
+//! @param[in] xml_path a string containing the path to the XML file
+//! @param[in] st the current state of the file
+//!
+//! @return a pointer to the cache entry or NULL if the file was not parsed since it last changed
+//!
+static xml_doc_cache *find_xml_doc(const char *xml_path, const struct stat *st)
+{
+    int i = 0;
+    xml_doc_cache *d = NULL;
+
+    for (i = 0; i < XML_DOC_CACHE_SIZE; i++) {
+        d = &xml_doc_cached[i];
+        if (d->doc && !strcmp(d->path, xml_path) && (d->st.st_ino == st->st_ino) && (d->st.st_size == st->st_size)
+            && (d->st.st_mtim.tv_sec == st->st_mtim.tv_sec) && (d->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec)) {
+            __sync_lock_test_and_set(&d->used, __sync_add_and_fetch(&xml_cache_clock, 1));   // other readers may be touching it too
+            return (d);
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Parses a file into the document cache, replacing the stale copy of the same file
+//! if there is one, or else a free or the least recently used entry. Must be called
+//! with xml_cache_lock held exclusively, since the replaced document is freed.
+//!
+//! @param[in] xml_path a string containing the path to the XML file
+//! @param[in] st the state of the file before it was parsed
+//!
+//! @return a pointer to the cache entry or NULL if the file could not be parsed
+//!
+static xml_doc_cache *load_xml_doc(const char *xml_path, const struct stat *st)
+{
+    int i = 0;
+    xmlDocPtr doc = NULL;
+    xml_doc_cache *d = NULL;
+    xml_doc_cache *victim = NULL;
+
+    if ((doc = xmlParseFile(xml_path)) == NULL)
+        return (NULL);
+
+    for (i = 0; i < XML_DOC_CACHE_SIZE; i++) {
+        d = &xml_doc_cached[i];
+        if (d->doc && !strcmp(d->path, xml_path)) {
+            victim = d;
+            break;
+        }
+        if ((victim == NULL) || (victim->doc && ((d->doc == NULL) || (d->used < victim->used))))
+            victim = d;
+    }
+
+    if (victim->doc)
+        xmlFreeDoc(victim->doc);
+    euca_strncpy(victim->path, xml_path, sizeof(victim->path));
+    victim->st = *st;
+    victim->doc = doc;
+    victim->used = __sync_add_and_fetch(&xml_cache_clock, 1);
+    return (victim);
+}
+
+//!
+//! Looks up a compiled expression in the XPath cache. Must be called with
+//! xml_cache_lock held, in either mode.
+//!
+//! @param[in] xpath a string contianing the XPATH expression
+//!
+//! @return a pointer to the cache entry or NULL if the expression was not compiled yet
+//!
+static xpath_cache *find_xpath(const char *xpath)
+{
+    int i = 0;
+    xpath_cache *c = NULL;
+
+    for (i = 0; i < XPATH_CACHE_SIZE; i++) {
+        c = &xpath_cached[i];
+        if (c->comp && !strcmp(c->expr, xpath)) {
+            __sync_lock_test_and_set(&c->used, __sync_add_and_fetch(&xml_cache_clock, 1));   // other readers may be touching it too
+            return (c);
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Compiles an expression into a free or the least recently used entry of the XPath
+//! cache. Must be called with xml_cache_lock held exclusively.
+//!
+//! @param[in] xpath a string contianing the XPATH expression
+//!
+//! @return a pointer to the cache entry or NULL if the expression is not valid
+//!
+static xpath_cache *compile_xpath(const char *xpath)
+{
+    int i = 0;
+    char *expr = NULL;
+    xmlXPathCompExprPtr comp = NULL;
+    xpath_cache *c = NULL;
+    xpath_cache *victim = NULL;
+
+    if ((comp = xmlXPathCompile((const xmlChar *)xpath)) == NULL)
+        return (NULL);
+
+    if ((expr = strdup(xpath)) == NULL) {
+        xmlXPathFreeCompExpr(comp);
+        return (NULL);
+    }
+
+    for (i = 0; i < XPATH_CACHE_SIZE; i++) {
+        c = &xpath_cached[i];
+        if ((victim == NULL) || (victim->comp && ((c->comp == NULL) || (c->used < victim->used))))
+            victim = c;
+    }
+
+    if (victim->comp) {
+        xmlXPathFreeCompExpr(victim->comp);
+        EUCA_FREE(victim->expr);
+    }
+    victim->expr = expr;
+    victim->comp = comp;
+    victim->used = __sync_add_and_fetch(&xml_cache_clock, 1);
+    return (victim);
+}
+
+//!
+//! Evaluates an xpath query against a file, using the cached parse of the file and the
+//! cached compiled form of the expression when they are current. Lookups that hit both
+//! caches only share xml_cache_lock, so queries from several threads run concurrently;
+//! a miss parses or compiles with the lock held exclusively. Either way the lock is
+//! still held on return, whatever the result, because the returned nodes belong to the
+//! cached document: the caller must release it with pthread_rwlock_unlock() once it is
+//! done with the result.
+//!
+//! @param[in]  xml_path a string containing the path to the XML file to parse
+//! @param[in]  xpath a string contianing the XPATH expression to evaluate
+//! @param[out] pdoc set to the document the result belongs to
+//!
+//! @return the result of the query (must be freed by caller) or NULL on failure
+//!
+static xmlXPathObjectPtr eval_cached_xpath(const char *xml_path, const char *xpath, xmlDocPtr * pdoc)
+{
+    struct stat st = { 0 };
+    xml_doc_cache *d = NULL;
+    xpath_cache *c = NULL;
+    xmlXPathContextPtr context = NULL;
+    xmlXPathObjectPtr result = NULL;
+
+    pthread_rwlock_rdlock(&xml_cache_lock);
+    if (stat(xml_path, &st) != 0) {
+        LOGDEBUG("failed to parse XML in '%s'\n", xml_path);
+        return (NULL);
+    }
+
+    if (((d = find_xml_doc(xml_path, &st)) == NULL) || ((c = find_xpath(xpath)) == NULL)) {
+        pthread_rwlock_unlock(&xml_cache_lock);
+        pthread_rwlock_wrlock(&xml_cache_lock);
+        // another thread may have filled the caches while the lock was released
+        if (((d = find_xml_doc(xml_path, &st)) == NULL) && ((d = load_xml_doc(xml_path, &st)) == NULL)) {
+            LOGDEBUG("failed to parse XML in '%s'\n", xml_path);
+            return (NULL);
+        }
+        if (((c = find_xpath(xpath)) == NULL) && ((c = compile_xpath(xpath)) == NULL)) {
+            LOGERROR("no results for '%s' in '%s'\n", xpath, xml_path);
+            return (NULL);
+        }
+    }
+
+    if ((context = xmlXPathNewContext(d->doc)) == NULL) {
+        LOGERROR("failed to set xpath '%s' context for '%s'\n", xpath, xml_path);
+        return (NULL);
+    }
+
+    if ((result = xmlXPathCompiledEval(c->comp, context)) == NULL) {
+        LOGERROR("no results for '%s' in '%s'\n", xpath, xml_path);
+    }
+    xmlXPathFreeContext(context);
+
+    *pdoc = d->doc;
+    return (result);
+}
+
 //!
 //! Places raw XML result of an xpath query into buf. The query must return
 //! only one element.
@@ -1325,60 +1815,46 @@ int gen_libvirt_volume_xml(const char *volumeId, const ncInstance * instance)
 //!
 //! @return EUCA_OK or EUCA_ERROR
 //!
+//! @see eval_cached_xpath()
+//!
 int get_xpath_xml(const char *xml_path, const char *xpath, char *buf, int buf_len)
 {
     int ret = EUCA_ERROR;
     xmlDocPtr doc = NULL;
-    xmlXPathContextPtr context = NULL;
     xmlXPathObjectPtr result = NULL;
     xmlNodeSetPtr nodeset = NULL;
 
     INIT();
 
     LOGTRACE("searching for '%s' in '%s'\n", xpath, xml_path);
-    pthread_mutex_lock(&xml_mutex);
-    {
-        if ((doc = xmlParseFile(xml_path)) != NULL) {
-            if ((context = xmlXPathNewContext(doc)) != NULL) {
-                if ((result = xmlXPathEvalExpression(((const xmlChar *)xpath), context)) != NULL) {
-                    if (!xmlXPathNodeSetIsEmpty(result->nodesetval)) {
-                        nodeset = result->nodesetval;
-                        if (nodeset->nodeNr > 1) {
-                            LOGERROR("multiple matches for '%s' in '%s'\n", xpath, xml_path);
-                        } else {
-                            xmlNodePtr node = nodeset->nodeTab[0]->xmlChildrenNode;
-                            xmlBufferPtr xbuf = xmlBufferCreate();
-                            if (xbuf) {
-                                int len = xmlNodeDump(xbuf, doc, node, 0, 1);
-                                if (len < 0) {
-                                    LOGERROR("failed to extract XML from %s\n", xpath);
-                                } else if (len > buf_len) {
-                                    LOGERROR("insufficient buffer for %s\n", xpath);
-                                } else {
-                                    char * str = (char*)xmlBufferContent(xbuf);
-                                    euca_strncpy(buf, str, buf_len);
-                                    ret = EUCA_OK;
-                                }
-                                xmlBufferFree(xbuf);
-                            } else {
-                                LOGERROR("failed to allocate XML buffer\n");
-                            }
-                        }
+    if ((result = eval_cached_xpath(xml_path, xpath, &doc)) != NULL) {
+        if (!xmlXPathNodeSetIsEmpty(result->nodesetval)) {
+            nodeset = result->nodesetval;
+            if (nodeset->nodeNr > 1) {
+                LOGERROR("multiple matches for '%s' in '%s'\n", xpath, xml_path);
+            } else {
+                xmlNodePtr node = nodeset->nodeTab[0]->xmlChildrenNode;
+                xmlBufferPtr xbuf = xmlBufferCreate();
+                if (xbuf) {
+                    int len = xmlNodeDump(xbuf, doc, node, 0, 1);
+                    if (len < 0) {
+                        LOGERROR("failed to extract XML from %s\n", xpath);
+                    } else if (len > buf_len) {
+                        LOGERROR("insufficient buffer for %s\n", xpath);
+                    } else {
+                        char * str = (char*)xmlBufferContent(xbuf);
+                        euca_strncpy(buf, str, buf_len);
+                        ret = EUCA_OK;
                     }
-                    xmlXPathFreeObject(result);
+                    xmlBufferFree(xbuf);
                 } else {
-                    LOGERROR("no results for '%s' in '%s'\n", xpath, xml_path);
+                    LOGERROR("failed to allocate XML buffer\n");
                 }
-                xmlXPathFreeContext(context);
-            } else {
-                LOGERROR("failed to set xpath '%s' context for '%s'\n", xpath, xml_path);
             }
-            xmlFreeDoc(doc);
-        } else {
-            LOGDEBUG("failed to parse XML in '%s'\n", xml_path);
         }
+        xmlXPathFreeObject(result);
     }
-    pthread_mutex_unlock(&xml_mutex);
+    pthread_rwlock_unlock(&xml_cache_lock);
 
     return ret;
 }
@@ -1392,51 +1868,37 @@ int get_xpath_xml(const char *xml_path, const char *xpath, char *buf, int buf_le
 //!
 //! @return a pointer to a list of strings (strings and array must be freed by caller)
 //!
+//! @see eval_cached_xpath()
+//!
 char **get_xpath_content(const char *xml_path, const char *xpath)
 {
     int i = 0;
     char **res = NULL;
     xmlChar *val = NULL;
     xmlDocPtr doc = NULL;
-    xmlXPathContextPtr context = NULL;
     xmlXPathObjectPtr result = NULL;
     xmlNodeSetPtr nodeset = NULL;
 
     INIT();
 
     LOGTRACE("searching for '%s' in '%s'\n", xpath, xml_path);
-    pthread_mutex_lock(&xml_mutex);
-    {
-        if ((doc = xmlParseFile(xml_path)) != NULL) {
-            if ((context = xmlXPathNewContext(doc)) != NULL) {
-                if ((result = xmlXPathEvalExpression(((const xmlChar *)xpath), context)) != NULL) {
-                    if (!xmlXPathNodeSetIsEmpty(result->nodesetval)) {
-                        nodeset = result->nodesetval;
-                        // We will add one more to have a NULL entry at the end
-                        res = EUCA_ZALLOC(nodeset->nodeNr + 1, sizeof(char *));
-                        for (i = 0; ((i < nodeset->nodeNr) && (res != NULL)); i++) {
-                            if ((nodeset->nodeTab[i]->children != NULL) && (nodeset->nodeTab[i]->children->content != NULL)) {
-                                val = nodeset->nodeTab[i]->children->content;
-                                res[i] = strdup(((char *)val));
-                            } else {
-                                res[i] = strdup("");    // when 'children' pointer is NULL, the XML element exists, but is empty
-                            }
-                        }
-                    }
-                    xmlXPathFreeObject(result);
+    if ((result = eval_cached_xpath(xml_path, xpath, &doc)) != NULL) {
+        if (!xmlXPathNodeSetIsEmpty(result->nodesetval)) {
+            nodeset = result->nodesetval;
+            // We will add one more to have a NULL entry at the end
+            res = EUCA_ZALLOC(nodeset->nodeNr + 1, sizeof(char *));
+            for (i = 0; ((i < nodeset->nodeNr) && (res != NULL)); i++) {
+                if ((nodeset->nodeTab[i]->children != NULL) && (nodeset->nodeTab[i]->children->content != NULL)) {
+                    val = nodeset->nodeTab[i]->children->content;
+                    res[i] = strdup(((char *)val));
                 } else {
-                    LOGERROR("no results for '%s' in '%s'\n", xpath, xml_path);
+                    res[i] = strdup("");    // when 'children' pointer is NULL, the XML element exists, but is empty
                 }
-                xmlXPathFreeContext(context);
-            } else {
-                LOGERROR("failed to set xpath '%s' context for '%s'\n", xpath, xml_path);
             }
-            xmlFreeDoc(doc);
-        } else {
-            LOGDEBUG("failed to parse XML in '%s'\n", xml_path);
         }
+        xmlXPathFreeObject(result);
     }
-    pthread_mutex_unlock(&xml_mutex);
+    pthread_rwlock_unlock(&xml_cache_lock);
     return (res);
 }
 
@@ -1579,6 +2041,12 @@ static void create_dummy_instance(const char *file)
     _ATTRIBUTE(os, "virtioDisk", "false");
     _ATTRIBUTE(os, "virtioNetwork", "true");
 
+    xmlNodePtr qos = _NODE(instance, "qos");
+    _ATTRIBUTE(qos, "diskIops", "500");
+    _ATTRIBUTE(qos, "diskBytes", "1048576");
+    _ATTRIBUTE(qos, "netInbound", "1000");
+    _ATTRIBUTE(qos, "netOutbound", "2000");
+
     groupNames = _NODE(instance, "groupNames");
     _ELEMENT(groupNames, "name", "mah-group-0");
     _ELEMENT(groupNames, "name", "mah-group-1");
@@ -1721,6 +2189,10 @@ int main(int argc, char **argv)
     LOGINFO("read dummy XML from %s into 'instance'\n", in_path);
 
     strncpy(instance.xmlFilePath, out_path2, sizeof(instance.xmlFilePath));
+    if (set_qos_profiles("m1.small:100 c1.medium:500:1048576:1000:2000") != 2) {
+        LOGERROR("failed to set the QoS profiles\n");
+        goto out;
+    }
     if (gen_instance_xml(&instance) != EUCA_OK) {
         LOGERROR("failed to create instance XML in %s\n", out_path2);
         goto out;
@@ -1778,6 +2250,13 @@ int main(int argc, char **argv)
         goto out;
     }
     LOGINFO("extracted %s as {%s}\n", xpath2, buf);
+    char * xpath3 = "/domain/devices/disk[1]/iotune/total_iops_sec";
+    if ((get_xpath_content_at(out_path, xpath3, 0, buf, sizeof(buf)) == NULL) || strcmp(buf, "500")) {
+        err = EUCA_ERROR;
+        LOGERROR("failed to read disk cap '%s' from '%s'\n", xpath3, out_path);
+        goto out;
+    }
+    LOGINFO("extracted %s as {%s}\n", xpath3, buf);
 
 out:
     if (err) {
@@ -86,6 +86,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define MAX_QOS_PROFILES                          32    //!< most VM types with a QoS profile in INSTANCE_QOS
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -104,6 +106,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Caps on each disk and network card of the instances of a VM type, 0 meaning no cap
+typedef struct qosProfile_t {
+    char vmType[64];                   //!< name of the VM type, or "*" for the VM types without a profile of their own
+    long long diskIops;                //!< most read and write operations per second
+    long long diskBytes;               //!< most bytes read and written per second
+    long long netInKBs;                //!< most KB per second received
+    long long netOutKBs;               //!< most KB per second sent
+} qosProfile;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -126,6 +137,8 @@ int gen_libvirt_volume_xml(const char *volumeId, const ncInstance * instance);
 int get_xpath_xml(const char *xml_path, const char *xpath, char *buf, int buf_len);
 char **get_xpath_content(const char *xml_path, const char *xpath);
 char *get_xpath_content_at(const char *xml_path, const char *xpath, int index, char *buf, int buf_len);
+int set_qos_profiles(const char *spec);
+boolean get_qos_profile(const char *vm_type, qosProfile * profile);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -86,6 +86,8 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -103,6 +105,7 @@
 #include "vbr.h"
 #include <ebs_utils.h>
 #include "xml.h"
+#include <instance_checkpoint.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -114,8 +117,19 @@
 #define STORE_TIMEOUT_USEC                       (1000000LL * 60 * 2)
 #define DELETE_TIMEOUT_USEC                      (1000000LL * 10)
 #define FIND_TIMEOUT_USEC                        (50000LL)  //! @TODO use 1000LL or less to induce rare timeouts
+#define CACHE_EVICT_HIGH_PERCENT                  95    //!< the cache is purged in the background once it is this full...
+#define CACHE_EVICT_LOW_PERCENT                   85    //!< ...down to this, leaving room for new images without purging in the foreground
+#define PRESTAGE_HISTORY                          32    //!< most images whose launches on this node are counted for pre-staging
+#define PRESTAGE_MIN_LAUNCHES                      2    //!< launches of an image after which it is kept in the cache by pre-staging
+#define PRESTAGE_MIN_PARTITION_LAUNCHES            1    //!< launches with an ephemeral or swap partition after which one like it is kept formatted in the cache
+#define PRESTAGE_RECHECK_SEC                      (60 * 60) //!< how often an image is checked for having been purged from the cache
+#define TIER_MIN_LAUNCHES                          3    //!< launches of an image after which it is worth a place in the fast tier of the cache
+#define TIER_HOT_SEC                              (60 * 60 * 24 * 7)    //!< an image not launched for this long is cold, however often it was launched before
+#define TIER_RECHECK_SEC                          (60 * 10) //!< how often an image is checked for being in the fast tier
+#define PERSIST_COALESCE_USEC                     (200 * 1000)  //!< how long the write-behind thread lets updates pile up before writing instance records
 
 #define INSTANCE_FILE_NAME                       "instance.xml"
+#define INSTANCE_CHECKPOINT_FILE_NAME            "instance.dat"
 #define INSTANCE_LIBVIRT_FILE_NAME               "instance-libvirt.xml"
 #define INSTANCE_CONSOLE_FILE_NAME               "console.log"
 
@@ -125,6 +139,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Launches of a downloadable image on this node, which decide whether it gets pre-staged
+typedef struct prestage_entry_t {
+    virtualBootRecord vbr;             //!< VBR of the image, as prepared for its last launch
+    int launches;                      //!< number of launches since the NC started
+    time_t last_launch;
+    time_t last_checked;               //!< when pre-staging last made sure that the image was in the cache
+    time_t last_tiered;                //!< when tiering last made sure that the image was in the fast tier of the cache
+} prestage_entry;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -161,11 +184,24 @@ extern struct nc_state_t nc_state;
 
 static char instances_path[EUCA_MAX_PATH] = "";
 static blobstore *cache_bs = NULL;
+static blobstore *fast_cache_bs = NULL; //!< OPTIONAL fast tier of the cache, on faster storage, for the hottest images
 static blobstore *work_bs = NULL;
 static sem *disk_sem = NULL;
 
 static bunchOfInstances **instances = NULL;
 
+static pthread_mutex_t prestage_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards the launch history
+static prestage_entry prestage_history[PRESTAGE_HISTORY];   //!< launch history of downloadable images
+static int prestage_history_len = 0;
+
+static pthread_mutex_t persist_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< guards the queue of instance records to write
+static pthread_cond_t persist_cond = PTHREAD_COND_INITIALIZER; //!< signaled when a record is queued
+static pthread_mutex_t persist_write_mutex = PTHREAD_MUTEX_INITIALIZER; //!< held while records are written, so that writes of an instance never go out of order
+static pthread_once_t persist_once = PTHREAD_ONCE_INIT;
+static boolean persist_started = FALSE;    //!< TRUE once the write-behind thread runs
+static ncInstanceCompact *persist_queue[MAXINSTANCES_PER_NC];   //!< latest unwritten compact copy of each instance with pending changes
+static int persist_queue_len = 0;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -173,11 +209,22 @@ static bunchOfInstances **instances = NULL;
 \*----------------------------------------------------------------------------*/
 
 static void bs_errors(const char *msg);
+static int write_instance_records(const ncInstance * instance, boolean durable);
+static void *persist_thread(void *arg);
+static void persist_start(void);
+static void persist_drop(const char *instanceId);
 static int stat_blobstore(const char *conf_instances_path, const char *name, blobstore_meta * meta);
 static void set_id(const ncInstance * instance, virtualBootRecord * vbr, char *id, unsigned int id_size);
 static void set_id2(const ncInstance * instance, const char *suffix, char *id, unsigned int id_size);
 static void set_path(char *path, unsigned int path_size, const ncInstance * instance, const char *filename);
 static int stale_blob_examiner(const blockblob * bb);
+static boolean prestage_is_wanted(const virtualBootRecord * vbr);
+static boolean prestage_is_same(const virtualBootRecord * a, const virtualBootRecord * b);
+static void prestage_record_launch(const virtualMachine * vm);
+static double tier_score(const prestage_entry * e, time_t now);
+static int compare_blob_meta(const void *a, const void *b);
+static long long demote_blob(const char *id);
+static int make_fast_cache_room(long long need_blocks, time_t idle_before, long long *moved);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -278,9 +325,444 @@ int check_backing_store(bunchOfInstances ** global_instances)
             return (EUCA_ERROR);
         }
     }
+
+    if (fast_cache_bs) {
+        if (blobstore_fsck(fast_cache_bs, NULL)) {
+            LOGERROR("fast tier of the cache failed integrity check: %s\n", blobstore_get_error_str(blobstore_get_error()));
+            return (EUCA_ERROR);
+        }
+    }
     return (EUCA_OK);
 }
 
+//!
+//! Purges least recently used images from the cache, if it is nearly full, so that
+//! launching an instance does not have to wait for that.
+//!
+//! @return EUCA_OK on success (including when there was nothing to purge) or EUCA_ERROR on failure.
+//!
+//! @see blobstore_evict()
+//!
+int evict_backing_store_cache(void)
+{
+    long long purged = 0;
+
+    if (cache_bs == NULL) {
+        return (EUCA_OK);
+    }
+
+    if ((purged = blobstore_evict(cache_bs, ((cache_bs->limit_blocks / 100) * CACHE_EVICT_HIGH_PERCENT), ((cache_bs->limit_blocks / 100) * CACHE_EVICT_LOW_PERCENT))) < 0) {
+        LOGWARN("failed to purge the cache: %s\n", blobstore_get_error_str(blobstore_get_error()));
+        return (EUCA_ERROR);
+    }
+
+    if (purged > 0) {
+        LOGINFO("purged %lld MB from the cache\n", (purged * 512) / MEGABYTE);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Gives back to the file system the blocks of idle cache blobs that hold nothing but zeroes.
+//! Work blobs are left alone, since running instances may be writing to their files without
+//! having them open, and guests give back the blocks of those by discarding them.
+//!
+//! @return EUCA_OK on success (including when there is no cache) or EUCA_ERROR on failure.
+//!
+//! @see blobstore_reclaim()
+//!
+int reclaim_backing_store(void)
+{
+    long long reclaimed = 0;
+
+    if (cache_bs == NULL) {
+        return (EUCA_OK);
+    }
+
+    if ((reclaimed = blobstore_reclaim(cache_bs)) < 0) {
+        LOGWARN("failed to reclaim zeroed blocks of the cache: %s\n", blobstore_get_error_str(blobstore_get_error()));
+        return (EUCA_ERROR);
+    }
+
+    if (reclaimed > 0) {
+        LOGINFO("reclaimed %lld MB of zeroed blocks from the cache\n", (reclaimed * 512) / MEGABYTE);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Tells whether a VBR is worth pre-staging: a downloadable image (machine image, kernel or ramdisk
+//! from object storage or a URL) or a blank ephemeral or swap partition, which gets formatted once
+//! into the cache and then only copied (or snapshotted) into the work blobstore of each instance
+//!
+//! @param[in] vbr
+//!
+//! @return TRUE if the VBR gets recorded in the launch history
+//!
+static boolean prestage_is_wanted(const virtualBootRecord * vbr)
+{
+    if ((vbr->type == NC_RESOURCE_IMAGE) || (vbr->type == NC_RESOURCE_KERNEL) || (vbr->type == NC_RESOURCE_RAMDISK))
+        return ((vbr->locationType == NC_LOCATION_OBJECT_STORAGE) || (vbr->locationType == NC_LOCATION_URL));
+    if ((vbr->type == NC_RESOURCE_EPHEMERAL) || (vbr->type == NC_RESOURCE_SWAP))
+        return ((vbr->locationType == NC_LOCATION_NONE) && !strcmp(vbr->id, "none"));
+    return (FALSE);
+}
+
+//!
+//! Tells whether two VBRs bring the same artifact into the cache. Images are identified by their
+//! location, while blank partitions, which all have location "none", are told apart by size and format.
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return TRUE if they are the same
+//!
+static boolean prestage_is_same(const virtualBootRecord * a, const virtualBootRecord * b)
+{
+    if ((a->type != b->type) || (a->locationType != b->locationType))
+        return (FALSE);
+    if (a->locationType == NC_LOCATION_NONE)
+        return ((a->sizeBytes == b->sizeBytes) && (a->format == b->format) && !strcmp(a->formatName, b->formatName));
+    return (!strcmp(a->resourceLocation, b->resourceLocation));
+}
+
+//!
+//! Counts the launch of the images and blank partitions of an instance that are worth pre-staging,
+//! replacing the least launched one if the history is full
+//!
+//! @param[in] vm the VM of the instance, with the VBRs as they were prepared for the launch
+//!
+static void prestage_record_launch(const virtualMachine * vm)
+{
+    int j = 0;
+    int victim = 0;
+    time_t now = time(NULL);
+    const virtualBootRecord *vbr = NULL;
+
+    pthread_mutex_lock(&prestage_mutex);
+    for (int i = 0; ((i < EUCA_MAX_VBRS) && (i < vm->virtualBootRecordLen)); i++) {
+        vbr = &(vm->virtualBootRecord[i]);
+        if (!prestage_is_wanted(vbr))
+            continue;
+
+        for (j = 0, victim = 0; j < prestage_history_len; j++) {
+            if (prestage_is_same(&(prestage_history[j].vbr), vbr))
+                break;
+            if ((prestage_history[j].launches < prestage_history[victim].launches)
+                || ((prestage_history[j].launches == prestage_history[victim].launches) && (prestage_history[j].last_launch < prestage_history[victim].last_launch)))
+                victim = j;
+        }
+        if (j == prestage_history_len) {  // not launched before
+            if (prestage_history_len < PRESTAGE_HISTORY)
+                victim = prestage_history_len++;
+            j = victim;
+            bzero(&(prestage_history[j]), sizeof(prestage_entry));
+        }
+        memcpy(&(prestage_history[j].vbr), vbr, sizeof(virtualBootRecord));
+        prestage_history[j].launches++;
+        prestage_history[j].last_launch = now;
+        prestage_history[j].last_checked = now;    // it is in the cache now
+    }
+    pthread_mutex_unlock(&prestage_mutex);
+}
+
+//!
+//! Brings back into the cache the most launched image or blank partition that may have been purged
+//! from it, as long as it fits under the level at which the cache gets purged. Meant to run when
+//! the node is idle, so that the next launch of a popular image does not wait for its download and
+//! that of a common instance type does not wait for its ephemeral and swap partitions to be formatted.
+//!
+//! @return the number of bytes added to the cache, 0 if there was nothing to do, or -1 on error
+//!
+long long prestage_backing_store(void)
+{
+    int rc = 0;
+    int best = -1;
+    int launches = 0;
+    time_t now = time(NULL);
+    long long room = 0;
+    long long added = 0;
+    artifact *sentinel = NULL;
+    blobstore_meta before = { 0 };
+    blobstore_meta after = { 0 };
+    virtualBootRecord vbr = { 0 };
+
+    if (cache_bs == NULL) {
+        return (0);
+    }
+
+    if (blobstore_stat(cache_bs, &before) == -1) {
+        return (-1);
+    }
+    // staging more than the cache holds after a purge would just purge what was staged
+    room = (((long long)before.blocks_limit / 100) * CACHE_EVICT_LOW_PERCENT) - (long long)(before.blocks_locked + before.blocks_unlocked);
+    room *= 512;
+
+    pthread_mutex_lock(&prestage_mutex);
+    for (int i = 0; i < prestage_history_len; i++) {
+        prestage_entry *e = &(prestage_history[i]);
+        int min_launches = ((e->vbr.locationType == NC_LOCATION_NONE) ? PRESTAGE_MIN_PARTITION_LAUNCHES : PRESTAGE_MIN_LAUNCHES);
+        if ((e->launches < min_launches) || ((now - e->last_checked) < PRESTAGE_RECHECK_SEC) || (e->vbr.sizeBytes > room))
+            continue;
+        if ((best == -1) || (e->launches > prestage_history[best].launches))
+            best = i;
+    }
+    if (best != -1) {
+        memcpy(&vbr, &(prestage_history[best].vbr), sizeof(virtualBootRecord));
+        launches = prestage_history[best].launches;
+        prestage_history[best].last_checked = now;
+    }
+    pthread_mutex_unlock(&prestage_mutex);
+
+    if (best == -1) {
+        return (0);
+    }
+
+    if ((sentinel = vbr_alloc_image_tree(&vbr, NULL, "prestage")) == NULL) {
+        LOGWARN("failed to prepare the pre-staging of %s\n", vbr.resourceLocation);
+        return (-1);
+    }
+    // a launch that needs the image meanwhile waits on this creation rather than duplicating it
+    rc = art_implement_tree(sentinel, work_bs, cache_bs, "", CACHE_TIMEOUT_USEC);
+    art_free(sentinel);
+    if (rc != EUCA_OK) {
+        LOGWARN("failed to pre-stage %s into the cache\n", vbr.resourceLocation);
+        return (-1);
+    }
+
+    if ((blobstore_stat(cache_bs, &after) == 0) && ((after.blocks_locked + after.blocks_unlocked) > (before.blocks_locked + before.blocks_unlocked))) {
+        added = (long long)((after.blocks_locked + after.blocks_unlocked) - (before.blocks_locked + before.blocks_unlocked)) * 512;
+        LOGINFO("pre-staged %s (%lld MB, launched %d times) into the cache\n", vbr.resourceLocation, added / MEGABYTE, launches);
+    }
+    return (added);
+}
+
+//!
+//! Rates how much an image deserves a place in the fast tier of the cache: the more it was
+//! launched and the more recently, the higher
+//!
+//! @param[in] e the launch history of the image
+//! @param[in] now
+//!
+//! @return the score, 0 for an image that is not hot
+//!
+static double tier_score(const prestage_entry * e, time_t now)
+{
+    if ((e->launches < TIER_MIN_LAUNCHES) || ((now - e->last_launch) > TIER_HOT_SEC))
+        return (0);
+    return ((double)e->launches / (1.0 + ((double)(now - e->last_launch) / 3600.0)));
+}
+
+//!
+//! Orders blobs from the least to the most recently used
+//!
+static int compare_blob_meta(const void *a, const void *b)
+{
+    const blockblob_meta *bm_a = *((const blockblob_meta **)a);
+    const blockblob_meta *bm_b = *((const blockblob_meta **)b);
+
+    if (bm_a->last_modified == bm_b->last_modified)
+        return (0);
+    return ((bm_a->last_modified < bm_b->last_modified) ? -1 : 1);
+}
+
+//!
+//! Demotes a blob out of the fast tier of the cache: copies it into the cache, unless the cache
+//! still has it, and then deletes it from the fast tier. A blob that cannot be copied is deleted
+//! all the same, since it can always be created again from its source.
+//!
+//! @param[in] id the blob
+//!
+//! @return the number of blocks freed in the fast tier or -1 if the blob is in use
+//!
+static long long demote_blob(const char *id)
+{
+    char *sig = NULL;
+    long long freed = 0;
+    blockblob *bb = NULL;
+    blockblob *down = NULL;
+
+    if ((bb = blockblob_open(fast_cache_bs, id, 0, 0, NULL, FIND_TIMEOUT_USEC)) == NULL)
+        return (-1);
+
+    // the cache may have purged its own copy while this one was being used
+    if ((down = blockblob_open(cache_bs, id, 0, 0, NULL, FIND_TIMEOUT_USEC)) != NULL) {
+        blockblob_close(down);
+    } else if (blobstore_get_error() == BLOBSTORE_ERROR_NOENT) {
+        if (((sig = EUCA_ALLOC(MAX_ARTIFACT_SIG, sizeof(char))) != NULL) && (blockblob_get_sig(bb, sig, MAX_ARTIFACT_SIG) != -1)
+            && ((down = blockblob_open(cache_bs, id, bb->size_bytes, (BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL), ((sig[0] != '\0') ? sig : NULL), STORE_TIMEOUT_USEC)) != NULL)) {
+            if (blockblob_copy(bb, 0, down, 0, 0) == -1) {
+                LOGWARN("failed to demote %s into the cache: %s\n", id, blobstore_get_error_str(blobstore_get_error()));
+                blockblob_delete(down, DELETE_TIMEOUT_USEC, 0);
+            } else {
+                LOGINFO("demoted %s (%lld MB) from the fast tier into the cache\n", id, (long long)(bb->size_bytes / MEGABYTE));
+                blockblob_close(down);
+            }
+        } else {
+            LOGWARN("failed to make room for demoting %s into the cache: %s\n", id, blobstore_get_error_str(blobstore_get_error()));
+        }
+        EUCA_FREE(sig);
+    }
+
+    freed = (long long)blockblob_get_size_blocks(bb);
+    if (blockblob_delete(bb, DELETE_TIMEOUT_USEC, 0) == -1) {
+        LOGWARN("failed to delete %s from the fast tier of the cache: %s\n", id, blobstore_get_error_str(blobstore_get_error()));
+        blockblob_close(bb);
+        return (-1);
+    }
+    return (freed);
+}
+
+//!
+//! Makes room in the fast tier of the cache by demoting the blobs that have been idle the
+//! longest, but only those idle since before the given time, so that an image is never
+//! promoted at the expense of one that is hotter
+//!
+//! @param[in]  need_blocks the room needed
+//! @param[in]  idle_before only blobs last used before this are demoted
+//! @param[out] moved bytes copied into the cache while demoting
+//!
+//! @return EUCA_OK if there is room or EUCA_NO_SPACE_ERROR otherwise
+//!
+static int make_fast_cache_room(long long need_blocks, time_t idle_before, long long *moved)
+{
+    int i = 0;
+    int found = 0;
+    long long room = 0;
+    long long freed = 0;
+    blobstore_meta meta = { 0 };
+    blockblob_meta *matches = NULL;
+    blockblob_meta *bm = NULL;
+    blockblob_meta *next = NULL;
+    blockblob_meta **sorted = NULL;
+
+    if (blobstore_stat(fast_cache_bs, &meta) == -1)
+        return (EUCA_NO_SPACE_ERROR);
+    if ((room = ((long long)meta.blocks_limit - (long long)(meta.blocks_locked + meta.blocks_unlocked))) >= need_blocks)
+        return (EUCA_OK);
+
+    if ((found = blobstore_search(fast_cache_bs, ".*", &matches)) <= 0)
+        return (EUCA_NO_SPACE_ERROR);
+    if ((sorted = EUCA_ZALLOC(found, sizeof(blockblob_meta *))) != NULL) {
+        for (i = 0, bm = matches; (bm != NULL) && (i < found); bm = bm->next)
+            sorted[i++] = bm;
+        found = i;
+        qsort(sorted, found, sizeof(blockblob_meta *), compare_blob_meta);
+
+        for (i = 0; (i < found) && (room < need_blocks) && (sorted[i]->last_modified < idle_before); i++) {
+            if (sorted[i]->in_use & (BLOCKBLOB_STATUS_OPENED | BLOCKBLOB_STATUS_MAPPED))
+                continue;
+            if ((freed = demote_blob(sorted[i]->id)) > 0) {
+                room += freed;
+                *moved += (freed * 512);
+            }
+        }
+        EUCA_FREE(sorted);
+    }
+
+    for (bm = matches; bm; bm = next) {
+        next = bm->next;
+        EUCA_FREE(bm);
+    }
+    return ((room >= need_blocks) ? EUCA_OK : EUCA_NO_SPACE_ERROR);
+}
+
+//!
+//! Promotes into the fast tier of the cache the hottest image, by the number and recency of its
+//! launches, that is in the cache but not in the fast tier yet, first demoting the blobs of the
+//! fast tier that have been idle the longest if there is no room for it. Meant to run when the
+//! node is idle, since launches that need the image wait while it is being copied.
+//!
+//! @return the number of bytes copied between the tiers, 0 if there was nothing to do, or -1 on error
+//!
+long long tier_backing_store_cache(void)
+{
+    int best = -1;
+    int launches = 0;
+    double score = 0;
+    double best_score = 0;
+    time_t now = time(NULL);
+    time_t last_launch = 0;
+    long long moved = 0;
+    long long need_blocks = 0;
+    artifact *sentinel = NULL;
+    artifact *a = NULL;
+    blockblob *src = NULL;
+    blockblob *dst = NULL;
+    virtualBootRecord vbr = { 0 };
+
+    if ((fast_cache_bs == NULL) || (cache_bs == NULL)) {
+        return (0);
+    }
+
+    pthread_mutex_lock(&prestage_mutex);
+    for (int i = 0; i < prestage_history_len; i++) {
+        prestage_entry *e = &(prestage_history[i]);
+        if ((now - e->last_tiered) < TIER_RECHECK_SEC)
+            continue;
+        if ((score = tier_score(e, now)) > best_score) {
+            best_score = score;
+            best = i;
+        }
+    }
+    if (best != -1) {
+        memcpy(&vbr, &(prestage_history[best].vbr), sizeof(virtualBootRecord));
+        launches = prestage_history[best].launches;
+        last_launch = prestage_history[best].last_launch;
+        prestage_history[best].last_tiered = now;
+    }
+    pthread_mutex_unlock(&prestage_mutex);
+
+    if (best == -1) {
+        return (0);
+    }
+
+    if ((sentinel = vbr_alloc_image_tree(&vbr, NULL, "tiering")) == NULL) {
+        LOGWARN("failed to prepare the tiering of %s\n", vbr.resourceLocation);
+        return (-1);
+    }
+    // the artifact that launches look up in the cache
+    a = sentinel->deps[0];
+    if ((a == NULL) || a->id_is_path || !a->may_be_cached) {
+        art_free(sentinel);
+        return (0);
+    }
+
+    if ((dst = blockblob_open(fast_cache_bs, a->id, 0, 0, a->sig, FIND_TIMEOUT_USEC)) != NULL) {
+        blockblob_close(dst);          // already there
+        art_free(sentinel);
+        return (0);
+    } else if (blobstore_get_error() == BLOBSTORE_ERROR_SIGNATURE) {
+        // an earlier version of the image, which will not be used again
+        if ((dst = blockblob_open(fast_cache_bs, a->id, 0, 0, NULL, FIND_TIMEOUT_USEC)) != NULL)
+            blockblob_delete(dst, DELETE_TIMEOUT_USEC, 0);
+        dst = NULL;
+    }
+    // an image that has been purged from the cache gets there through pre-staging or a launch first
+    if ((src = blockblob_open(cache_bs, a->id, 0, 0, a->sig, FIND_TIMEOUT_USEC)) == NULL) {
+        art_free(sentinel);
+        return (0);
+    }
+
+    need_blocks = (long long)blockblob_get_size_blocks(src);
+    if (make_fast_cache_room(need_blocks, last_launch, &moved) != EUCA_OK) {
+        LOGDEBUG("no room in the fast tier of the cache for %s without demoting hotter images\n", a->id);
+    } else if ((dst = blockblob_open(fast_cache_bs, a->id, src->size_bytes, (BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL), a->sig, STORE_TIMEOUT_USEC)) == NULL) {
+        LOGWARN("failed to create %s in the fast tier of the cache: %s\n", a->id, blobstore_get_error_str(blobstore_get_error()));
+    } else if (blockblob_copy(src, 0, dst, 0, 0) == -1) {
+        LOGWARN("failed to promote %s into the fast tier of the cache: %s\n", a->id, blobstore_get_error_str(blobstore_get_error()));
+        blockblob_delete(dst, DELETE_TIMEOUT_USEC, 0);
+    } else {
+        moved += (long long)src->size_bytes;
+        LOGINFO("promoted %s (%lld MB, launched %d times) into the fast tier of the cache\n", a->id, (long long)(src->size_bytes / MEGABYTE), launches);
+        blockblob_close(dst);
+    }
+
+    blockblob_close(src);
+    art_free(sentinel);
+    return (moved);
+}
+
 //!
 //! Stats the backing blobstores (work and cache) created under the given path.
 //!
@@ -335,7 +817,10 @@ int init_backing_store(const char *conf_instances_path, unsigned int conf_work_s
     char work_path[EUCA_MAX_PATH] = "";
     unsigned long long cache_limit_blocks = 0;
     unsigned long long work_limit_blocks = 0;
+    int cache_io_policy = 0;
+    int work_io_policy = 0;
     blobstore_snapshot_t snapshot_policy = BLOBSTORE_SNAPSHOT_ANY;
+    blobstore_snapshot_t work_snapshot_policy = BLOBSTORE_SNAPSHOT_ANY;
 
     LOGINFO("initializing backing store...\n");
 
@@ -360,6 +845,15 @@ int init_backing_store(const char *conf_instances_path, unsigned int conf_work_s
     if (ensure_directories_exist(work_path, 0, NULL, NULL, BACKING_DIRECTORY_PERM) == -1)
         return (EUCA_ACCESS_ERROR);
 
+    // how copies, zeroing and downloads into each blobstore treat the page cache of the node
+    if ((diskutil_parse_io_policy(nc_state.cache_io_policy, &cache_io_policy) != EUCA_OK)
+        || (diskutil_parse_io_policy(nc_state.work_io_policy, &work_io_policy) != EUCA_OK)) {
+        LOGERROR("invalid %s (%s) or %s (%s)\n", CONFIG_CACHE_IO_POLICY, nc_state.cache_io_policy, CONFIG_WORK_IO_POLICY, nc_state.work_io_policy);
+        return (EUCA_INVALID_ERROR);
+    }
+    diskutil_set_io_policy(cache_path, cache_io_policy);
+    diskutil_set_io_policy(work_path, work_io_policy);
+
     // convert MB to blocks
     cache_limit_blocks = (unsigned long long)conf_cache_size_mb *2048;
     work_limit_blocks = (unsigned long long)conf_work_size_mb *2048;
@@ -386,14 +880,49 @@ int init_backing_store(const char *conf_instances_path, unsigned int conf_work_s
             return (EUCA_PERMISSION_ERROR);
         }
     }
+    // a fast tier over the cache, on faster storage, holding copies of the most launched images;
+    // it is optional, so the node goes on without it if it cannot be had
+    if (cache_bs && (strlen(nc_state.fast_cache_path) > 0) && (nc_state.fast_cache_size_mb > 0)) {
+        if (ensure_directories_exist(nc_state.fast_cache_path, 0, NULL, NULL, BACKING_DIRECTORY_PERM) == -1) {
+            LOGWARN("cannot create %s (%s), continuing without a fast tier of the cache\n", CONFIG_NC_FAST_CACHE_PATH, nc_state.fast_cache_path);
+        } else {
+            diskutil_set_io_policy(nc_state.fast_cache_path, cache_io_policy);
+            fast_cache_bs = blobstore_open(nc_state.fast_cache_path, ((unsigned long long)nc_state.fast_cache_size_mb * 2048), BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_DIRECTORY,
+                                           BLOBSTORE_REVOCATION_NONE, snapshot_policy);
+            if (fast_cache_bs == NULL) {
+                LOGWARN("failed to open/create fast cache blobstore, continuing without it: %s\n", blobstore_get_error_str(blobstore_get_error()));
+            } else {
+                LOGINFO("using %s as the fast tier of the cache, with up to %d MB\n", nc_state.fast_cache_path, nc_state.fast_cache_size_mb);
+                vbr_set_fast_cache(fast_cache_bs);
+            }
+        }
+    }
+    // instances are cloned in the work blobstore, which can snapshot into a thin pool instead
+    work_snapshot_policy = snapshot_policy;
+    if (nc_state.thin_snapshots && !nc_state.disable_snapshots) {
+        LOGINFO("if allocating storage, will use thin snapshots\n");
+        work_snapshot_policy = BLOBSTORE_SNAPSHOT_THIN;
+    }
     // Lets open the work blobstore
-    work_bs = blobstore_open(work_path, work_limit_blocks, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_NONE, snapshot_policy);
+    work_bs = blobstore_open(work_path, work_limit_blocks, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_NONE, work_snapshot_policy);
     if (work_bs == NULL) {
         LOGERROR("failed to open/create work blobstore: %s\n", blobstore_get_error_str(blobstore_get_error()));
         LOGERROR("%s\n", blobstore_get_last_trace());
         BLOBSTORE_CLOSE(cache_bs);
+        if (fast_cache_bs) {
+            vbr_set_fast_cache(NULL);
+            BLOBSTORE_CLOSE(fast_cache_bs);
+        }
         return (EUCA_PERMISSION_ERROR);
     }
+    // count cached images by the blocks they take up, once zeroed blocks are punched out of them
+    // or once they are compressed, which leaves a hole where the rest of the raw image was
+    if ((nc_state.reclaim_sparse_blocks || nc_state.compress_cached_images) && cache_bs) {
+        LOGINFO("will count only the allocated blocks of cached images against the cache limit\n");
+        blobstore_set_sparse_accounting(cache_bs, TRUE);
+        if (fast_cache_bs)
+            blobstore_set_sparse_accounting(fast_cache_bs, TRUE);
+    }
     // set the initial value of the semaphore to the number of
     // disk-intensive operations that can run in parallel on this node
     if (nc_state.concurrent_disk_ops && ((disk_sem = sem_alloc(nc_state.concurrent_disk_ops, IPC_MUTEX_SEMAPHORE)) == NULL)) {
@@ -579,32 +1108,206 @@ static int stale_blob_examiner(const blockblob * bb)
 }
 
 //!
-//! Save the instance structure data in the instance.checkpoint file under the instance's
-//! work blobstore path.
+//! Writes the records of an instance: the XML, which libvirt XML is generated from, then the
+//! binary checkpoint, which load_instance_struct() reads in its place when it is not older.
+//! A checkpoint that could not be written is removed, so that a stale one is never loaded.
 //!
 //! @param[in] instance pointer to the instance to save
+//! @param[in] durable whether to flush both records to disk before returning
 //!
-//! @return EUCA_OK on success of the following error codes:
-//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
-//!         \li EUCA_PERMISSION_ERROR: if we fail to open/create the checkpoint file
-//!         \li EUCA_IO_ERROR: if we fail to save the instance in the checkpoint file
+//! @return EUCA_OK on success or the error code of gen_instance_xml()
+//!
+static int write_instance_records(const ncInstance * instance, boolean durable)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    char checkpoint_path[EUCA_MAX_PATH] = "";
+
+    if ((ret = gen_instance_xml(instance)) != EUCA_OK)
+        return (ret);
+
+    if (durable && ((fd = open(instance->xmlFilePath, O_RDONLY)) >= 0)) {
+        fsync(fd);
+        close(fd);
+    }
+
+    set_path(checkpoint_path, sizeof(checkpoint_path), instance, INSTANCE_CHECKPOINT_FILE_NAME);
+    if (write_instance_checkpoint(instance, checkpoint_path, BACKING_FILE_PERM, durable) != EUCA_OK) {
+        LOGWARN("[%s] failed to save instance checkpoint, the XML will be loaded instead\n", instance->instanceId);
+        unlink(checkpoint_path);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Write-behind thread that writes the instance records queued by save_instance_struct(). It
+//! waits a little after the first update of a burst, so that repeated updates of an instance,
+//! e.g., during a mass launch or termination, end up in a single write.
+//!
+//! @param[in] arg the instance struct that queued copies are expanded into, owned by the thread
+//!
+//! @return Always return NULL
+//!
+static void *persist_thread(void *arg)
+{
+    ncInstance *instance = ((ncInstance *) arg);
+    ncInstanceCompact *copy = NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&persist_mutex);
+        while (persist_queue_len == 0)
+            pthread_cond_wait(&persist_cond, &persist_mutex);
+        pthread_mutex_unlock(&persist_mutex);
+
+        usleep(PERSIST_COALESCE_USEC);
+
+        pthread_mutex_lock(&persist_write_mutex);
+        for (;;) {
+            pthread_mutex_lock(&persist_mutex);
+            copy = ((persist_queue_len > 0) ? persist_queue[--persist_queue_len] : NULL);
+            pthread_mutex_unlock(&persist_mutex);
+            if (copy == NULL)
+                break;
+
+            if ((expand_instance(copy, instance) != EUCA_OK) || (write_instance_records(instance, FALSE) != EUCA_OK)) {
+                LOGERROR("[%s] failed to save instance record\n", copy->instanceId);
+            }
+            free_compact_instance(copy);
+            EUCA_FREE(copy);
+        }
+        pthread_mutex_unlock(&persist_write_mutex);
+    }
+    return (NULL);
+}
+
+//!
+//! Starts the write-behind thread, once per process
+//!
+static void persist_start(void)
+{
+    pthread_t thread = { 0 };
+    ncInstance *instance = NULL;
+
+    if (((instance = EUCA_ZALLOC(1, sizeof(ncInstance))) == NULL) || (pthread_create(&thread, NULL, persist_thread, instance) != 0)) {
+        LOGWARN("failed to start the instance record writer, records will be written synchronously\n");
+        EUCA_FREE(instance);
+        return;
+    }
+    pthread_detach(thread);
+    persist_started = TRUE;
+}
+
+//!
+//! Removes the queued record of an instance, if any. Must be called with persist_write_mutex
+//! held, so that no write of the instance is in progress either.
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+static void persist_drop(const char *instanceId)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&persist_mutex);
+    for (i = 0; i < persist_queue_len; i++) {
+        if (!strcmp(persist_queue[i]->instanceId, instanceId)) {
+            free_compact_instance(persist_queue[i]);
+            EUCA_FREE(persist_queue[i]);
+            persist_queue[i] = persist_queue[--persist_queue_len];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&persist_mutex);
+}
+
+//!
+//! Save the instance structure data in the instance.xml file, and its binary checkpoint in
+//! instance.dat, under the instance's work blobstore path. The record is written behind the caller's back, shortly after,
+//! by a thread that coalesces repeated updates of an instance; use sync_instance_struct()
+//! where the record must be on disk before proceeding. The queue holds compact copies, which
+//! keep only what the records keep.
+//!
+//! @param[in] instance pointer to the instance to save
+//!
+//! @return EUCA_OK if the record was queued or written, or the error of gen_instance_xml()
+//!         if it had to be written synchronously and that failed
 //!
 //! @pre The instance variable must not be NULL.
 //!
-//! @post On success, the checkpoint file is created and contains the instance information
+//! @post The instance record will be written to disk, unless a later save supersedes it
 //!
 int save_instance_struct(const ncInstance * instance)
 {
+    int i = 0;
+    ncInstanceCompact *copy = NULL;
+    ncInstanceCompact *old = NULL;
+
     if (instance->state == TEARDOWN) {
-        return EUCA_OK;                // instance is without disk state => nowhere to write metadata
-    } else {
-        return gen_instance_xml(instance);
+        // instance is without disk state => nowhere to write metadata, including any queued earlier
+        pthread_mutex_lock(&persist_write_mutex);
+        persist_drop(instance->instanceId);
+        pthread_mutex_unlock(&persist_write_mutex);
+        return EUCA_OK;
+    }
+
+    pthread_once(&persist_once, persist_start);
+    if (persist_started && ((copy = EUCA_ZALLOC(1, sizeof(ncInstanceCompact))) != NULL)) {
+        // compacted outside of the lock, so that the writer is not held up by the encoding
+        if (compact_instance(instance, copy) != EUCA_OK) {
+            EUCA_FREE(copy);
+        } else {
+            pthread_mutex_lock(&persist_mutex);
+            for (i = 0; (i < persist_queue_len) && strcmp(persist_queue[i]->instanceId, instance->instanceId); i++) ;
+            if (i < persist_queue_len) {
+                old = persist_queue[i]; // coalesce with the update not yet written
+                persist_queue[i] = copy;
+            } else if (persist_queue_len < MAXINSTANCES_PER_NC) {
+                persist_queue[persist_queue_len++] = copy;
+            } else {
+                old = copy;
+                copy = NULL;
+            }
+            if (copy)
+                pthread_cond_signal(&persist_cond);
+            pthread_mutex_unlock(&persist_mutex);
+
+            if (old) {
+                free_compact_instance(old);
+                EUCA_FREE(old);
+            }
+            if (copy)
+                return EUCA_OK;
+        }
+    }
+
+    return (sync_instance_struct(instance));
+}
+
+//!
+//! Writes the instance structure data to the instance records right away, superseding any
+//! update queued by save_instance_struct(), and makes it durable. Meant for the points where
+//! losing the record in a crash would leave the NC unable to recover the instance, such as
+//! right before its domain is created.
+//!
+//! @param[in] instance pointer to the instance to save
+//!
+//! @return EUCA_OK on success or the error code of gen_instance_xml()
+//!
+int sync_instance_struct(const ncInstance * instance)
+{
+    int ret = EUCA_OK;
+
+    pthread_mutex_lock(&persist_write_mutex);
+    {
+        persist_drop(instance->instanceId);
+        ret = write_instance_records(instance, TRUE);
     }
+    pthread_mutex_unlock(&persist_write_mutex);
+    return (ret);
 }
 
 //!
-//! Loads an instance structure data from the instance.xml file under the instance's
-//! work blobstore path.
+//! Loads an instance structure data from the instance.dat binary checkpoint under the instance's
+//! work blobstore path or, if there is none that is as recent, from the instance.xml file.
 //!
 //! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
 //!
@@ -621,9 +1324,14 @@ ncInstance *load_instance_struct(const char *instanceId)
     char tmp_path[EUCA_MAX_PATH] = "";
     char user_paths[EUCA_MAX_PATH] = "";
     char checkpoint_path[EUCA_MAX_PATH] = "";
+    char binary_path[EUCA_MAX_PATH] = "";
+    int rc = 0;
+    int version = 0;
+    boolean resave = TRUE;
     ncInstance *instance = NULL;
     struct dirent *dir_entry = NULL;
     struct stat mystat = { 0 };
+    struct stat xmlstat = { 0 };
 
     // Allocate memory for our instance
     if ((instance = EUCA_ZALLOC(1, sizeof(ncInstance))) == NULL) {
@@ -698,7 +1406,32 @@ ncInstance *load_instance_struct(const char *instanceId)
         }
         memcpy(instance, &instance33, sizeof(ncInstance33));
         LOGINFO("[%s] upgraded instance checkpoint from v3.3\n", instance->instanceId);
-    } else {                           // no binary checkpoint, so we expect an XML-formatted checkpoint
+        goto loaded;
+    }
+
+    // Use the compact checkpoint when it was written after the XML, which it always is unless
+    // writing it failed or an older version of the NC, which knows only of the XML, ran since.
+    set_path(binary_path, sizeof(binary_path), instance, INSTANCE_CHECKPOINT_FILE_NAME);
+    if ((stat(binary_path, &mystat) == 0)
+        && ((stat(instance->xmlFilePath, &xmlstat) != 0) || (mystat.st_mtim.tv_sec > xmlstat.st_mtim.tv_sec)
+            || ((mystat.st_mtim.tv_sec == xmlstat.st_mtim.tv_sec) && (mystat.st_mtim.tv_nsec >= xmlstat.st_mtim.tv_nsec)))) {
+        if ((rc = read_instance_checkpoint(binary_path, instance, &version)) == EUCA_OK) {
+            LOGDEBUG("[%s] loaded instance checkpoint of version %d\n", instance->instanceId, version);
+            // rewrite only to bring an older checkpoint up to date
+            resave = (version < INSTANCE_CHECKPOINT_VERSION);
+            goto loaded;
+        }
+        LOGWARN("[%s] failed to read instance checkpoint %s (error=%d), loading the XML instead\n", instance->instanceId, binary_path, rc);
+
+        // start over from a clean struct, the checkpoint may have set some of it
+        euca_strncpy(tmp_path, instance->userId, sizeof(tmp_path));
+        bzero(instance, sizeof(ncInstance));
+        euca_strncpy(instance->instanceId, instanceId, sizeof(instance->instanceId));
+        euca_strncpy(instance->userId, tmp_path, sizeof(instance->userId));
+        set_instance_paths(instance);
+    }
+
+    {                                  // no usable compact checkpoint, so we expect an XML-formatted one
         char *xmlFP;
         if ((xmlFP = EUCA_ALLOC(sizeof(instance->xmlFilePath), sizeof(char))) == NULL) {
             LOGERROR("out of memory (for temporary string allocation)\n");
@@ -713,6 +1446,7 @@ ncInstance *load_instance_struct(const char *instanceId)
         EUCA_FREE(xmlFP);
     }
 
+loaded:
     // Reset some fields for safety since they would now be wrong
     instance->stateCode = NO_STATE;
     instance->params.root = NULL;
@@ -727,7 +1461,7 @@ ncInstance *load_instance_struct(const char *instanceId)
     // perform any upgrade-related manipulations to bring the struct up to date
 
     // save the struct back to disk after the upgrade routine had a chance to modify it
-    if (gen_instance_xml(instance) != EUCA_OK) {
+    if (resave && (sync_instance_struct(instance) != EUCA_OK)) {
         LOGERROR("failed to create instance XML in %s\n", instance->xmlFilePath);
         goto free;
     }
@@ -834,6 +1568,9 @@ int create_instance_backing(ncInstance * instance, boolean is_migration_dest)
     if (save_instance_struct(instance)) // update instance checkpoint now that the struct got updated
         goto out;
 
+    if (!is_migration_dest)
+        prestage_record_launch(vm);
+
     ret = EUCA_OK;
 
 out:
@@ -970,6 +1707,12 @@ int destroy_instance_backing(ncInstance * instance, boolean do_destroy_files)
         }
     }
 
+    // a queued update of the record must not recreate files of an instance being cleaned up
+    if (do_destroy_files) {
+        pthread_mutex_lock(&persist_write_mutex);
+        persist_drop(instance->instanceId);
+        pthread_mutex_unlock(&persist_write_mutex);
+    }
     // see if instance directory is there (sometimes startup fails before it is created)
     set_path(path, sizeof(path), instance, NULL);
     if (check_path(path))
@@ -121,8 +121,13 @@
 
 int check_backing_store(bunchOfInstances ** global_instances);
 int stat_backing_store(const char *conf_instances_path, blobstore_meta * work_meta, blobstore_meta * cache_meta);
+int evict_backing_store_cache(void);
+int reclaim_backing_store(void);
+long long prestage_backing_store(void);
+long long tier_backing_store_cache(void);
 int init_backing_store(const char *conf_instances_path, unsigned int conf_work_size_mb, unsigned int conf_cache_size_mb);
 int save_instance_struct(const ncInstance * instance);
+int sync_instance_struct(const ncInstance * instance);
 ncInstance *load_instance_struct(const char *instanceId);
 
 int create_instance_backing(ncInstance * instance, boolean is_migration_dest);
@@ -79,6 +79,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>                    // LLONG_MAX
 #include <unistd.h>                    // close
 #include <time.h>                      // time
 #include <sys/time.h>                  // gettimeofday
@@ -86,6 +87,8 @@
 #include <errno.h>                     // errno
 #include <sys/types.h>                 // *dir, etc, wait
 #include <sys/file.h>                  // flock
+#include <fcntl.h>                     // open
+#include <signal.h>                    // kill
 #include <dirent.h>
 #include <sys/wait.h>                  // wait
 #include <pthread.h>
@@ -94,9 +97,12 @@
 #include <libgen.h>                    // basename
 
 #include <eucalyptus.h>                // euca user
+#include <eucalyptus-config.h>         // HAVE_LIBDEVMAPPER
 #include <misc.h>                      // ensure_...
 #include <ipc.h>
 #include <euca_string.h>
+#include <thread_pool.h>
+#include <euca_probe.h>
 
 #include "blobstore.h"
 #include "diskutil.h"
@@ -105,6 +111,10 @@
 #include "map.h"
 #endif /* _EUCA_BLOBS */
 
+#ifdef HAVE_LIBDEVMAPPER
+#include <libdevmapper.h>
+#endif /* HAVE_LIBDEVMAPPER */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -112,6 +122,26 @@
 \*----------------------------------------------------------------------------*/
 
 #define BLOBSTORE_METADATA_FILE                  ".blobstore"
+#define BLOBSTORE_INDEX_FILE                     ".blobstore.index" //!< compacted table of all blobs in the store, one record per blob
+#define BLOBSTORE_INDEX_TMP_FILE                 ".blobstore.index.tmp"
+#define BLOBSTORE_JOURNAL_FILE                   ".blobstore.journal"   //!< records appended on every blob open, close, delete and reference change
+#define BLOBSTORE_INDEX_HEADER                   "# blobstore index v1\n"
+#define BLOBSTORE_INDEX_COMPACT_RECORDS             4096    //!< journal records beyond which the journal is folded into the table...
+#define BLOBSTORE_INDEX_COMPACT_RATIO                  2    //!< ...provided it also has this many times more records than there are blobs
+#define BLOBSTORE_INDEX_RECORD_SIZE              (BLOBSTORE_MAX_PATH * 2 + MAX_DM_NAME + 128)
+#define BLOBSTORE_MAX_PACKED_METADATA            (1024 * 1024)  //!< sanity limit on the size of a packed .meta record
+#define BLOBSTORE_CONTENT_INDEX_FILE             ".blobstore.content"   //!< content key and ID of cached blobs, one pair per line
+#define BLOBSTORE_FSCK_FILE                      ".blobstore.fsck"  //!< blobs found consistent by the last fsck, with the state of their metadata then
+#define BLOBSTORE_FSCK_TMP_FILE                  ".blobstore.fsck.tmp"
+#define BLOBSTORE_FSCK_HEADER                    "# blobstore fsck v1\n"
+#define BLOBSTORE_FSCK_WORKERS                         8    //!< worker threads of fsck_pool, checking the devices of blobs, which mostly wait on dmsetup and losetup
+#define BLOBSTORE_BOOT_ID_PATH                   "/proc/sys/kernel/random/boot_id"
+#define BLOBSTORE_POOL_FILE                      ".blobstore.pool"  //!< loop devices and next thin device ID of the thin pool of the store
+#define BLOBSTORE_POOL_DATA_FILE                 ".blobstore.pool.data" //!< sparse file backing the data device of the thin pool
+#define BLOBSTORE_POOL_META_FILE                 ".blobstore.pool.meta" //!< sparse file backing the metadata device of the thin pool
+#define BLOBSTORE_POOL_BLOCK_SECTORS                 128    //!< 64K thin pool blocks, the smallest size with which a pool can have external origins of any alignment
+#define BLOBSTORE_POOL_MIN_META_BYTES            (2 * 1024 * 1024)  //!< smallest metadata device for the thin pool
+#define BLOBSTORE_POOL_MAX_THIN_ID              0xFFFFFF    //!< largest ID of a thin device in a pool
 #define BLOBSTORE_METADATA_TIMEOUT_USEC          (1000000LL * 60 * 2)   //!< it may take dozens of seconds to open blobstore when others are LRU-purging it
 #define BLOBSTORE_LOCK_TIMEOUT_USEC               500000LL
 #define BLOBSTORE_FIND_TIMEOUT_USEC                50000LL
@@ -160,6 +190,19 @@
 #define COMPETITIVE_TIMEOUT_USEC                 3000000L
 #endif /* _UNIT_TEST */
 
+#ifdef _BENCHMARK
+#define BENCH_DEFAULT_COUNTS                     "100,1000,10000,100000"
+#define BENCH_DEFAULT_THREADS                    "1,4,16"
+#define BENCH_DEFAULT_SNAPSHOTS                  "none,dm,thin"
+#define BENCH_BLOB_BLOCKS                             8 //!< size of every benchmark blob, in 512-byte blocks
+#define BENCH_CLONES                                100 //!< most blobs copied and cloned in each configuration
+#define BENCH_SEARCHES                                5 //!< full searches of the store in each configuration
+#define BENCH_MAX_OPS                             10000 //!< most opens per concurrency level
+#define BENCH_MAX_THREADS                            64
+#define BENCH_PRESSURE_PERCENT                       10 //!< blobs created in the full store, as a percentage of the blob count
+#define BENCH_TIMEOUT_USEC                    10000000L
+#endif /* _BENCHMARK */
+
 #ifdef _EUCA_BLOBS
 #define USAGE                                    "Usage: euca-blobs [cache=... work=...] command [param1] [param2]...\n"
 #define HELP                                     "\n"                                         \
@@ -192,6 +235,8 @@ typedef enum {                         //!< paths to files containing...
     BLOCKBLOB_PATH_SIG,                //!< ...signature of the blob, if provided from outside
     BLOCKBLOB_PATH_REFS,               //!< ...names of blockblobs that depend on this blockblob, if any
     BLOCKBLOB_PATH_HOLLOW,             //!< ...nothing, but the file acts as a marker of 'hollow' blobs
+    BLOCKBLOB_PATH_THIN,               //!< ...IDs of the thin devices created in the thin pool of the store for this clone, if any
+    BLOCKBLOB_PATH_META,               //!< ...all of the above that hold metadata (DM through THIN), packed into one record
     BLOCKBLOB_PATH_TOTAL,
 } blockblob_path_t;
 
@@ -207,6 +252,28 @@ enum {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#ifdef _BENCHMARK
+//! Latencies of one benchmarked operation
+typedef struct _bench_samples {
+    long long *usec;                   //!< latency of every successful call, in microseconds
+    int len;                           //!< number of entries in usec[]
+    int size;                          //!< room in usec[]
+    int failed;                        //!< number of failed calls
+    long long elapsed_usec;            //!< wall-clock time of the phase, for the throughput
+} bench_samples;
+
+//! Thread of the concurrent open/close phase of the benchmark
+typedef struct _bench_worker {
+    pthread_t thread;
+    blobstore *bs;                     //!< the store, shared by all threads
+    int count;                         //!< number of blobs in the store
+    int ops;                           //!< number of opens to do
+    unsigned int seed;                 //!< rand_r() state
+    bench_samples open;
+    bench_samples close;
+} bench_worker;
+#endif /* _BENCHMARK */
+
 typedef struct _blobstore_filelock {
     char path[PATH_MAX];               //!< path that the file was open with @TODO canonicalize?
     int refs;                          //!< number of open file descriptors (some holding the lock, some waiting) for this path in this process
@@ -222,6 +289,80 @@ typedef struct _blobstore_filelock {
     struct _blobstore_filelock *next;  //!< pointer for constructing a LL
 } blobstore_filelock;
 
+//! One blob, as last recorded in the blob index of the store
+typedef struct _blobstore_index_entry {
+    char *id;                          //!< ID of the blob or NULL if this entry was removed and can be reused
+    char *device_path;                 //!< device the blob was accessible on when last recorded
+    char *dm_name;                     //!< main device mapper device of the blob, if it is a clone
+    unsigned long long size_bytes;     //!< size of the blob, less the blocks mapped from other blobs
+    unsigned long long blocks_allocated;    //!< blocks taken on disk by the content file
+    time_t last_accessed;
+    time_t last_modified;
+    unsigned int in_use;               //!< BLOCKBLOB_STATUS_MAPPED and BLOCKBLOB_STATUS_BACKED, as they were when recorded
+    unsigned char is_hollow;
+    pid_t opener;                      //!< process that has the blob open, 0 if closed or -1 if the lock file holds garbage
+    int heap_pos;                      //!< position of the entry in the LRU heap, -1 if it is not in it
+} blobstore_index_entry;
+
+//! In-memory copy of the on-disk blob index (the table plus the journal replayed on top of it)
+typedef struct _blobstore_index {
+    blobstore_index_entry *entries;
+    int entries_size;                  //!< entries in use, including removed ones
+    int entries_max;                   //!< entries allocated
+    int live;                          //!< entries that hold a blob
+    int *slots;                        //!< open addressing hash of the IDs, entries are (index + 1) and 0 when free
+    int slots_size;                    //!< always a power of two and at least twice entries_max
+    int *heap;                         //!< min-heap of entries (indexes into the array above) by last modification, for LRU purging
+    int heap_size;
+    unsigned long long blocks_used;    //!< blocks taken by all blobs that count toward the store limit
+    unsigned long long blocks_opened;  //!< the part of blocks_used taken by blobs recorded as open
+    ino_t table_ino;                   //!< identity of the table file the entries were loaded from
+    off_t table_size;
+    time_t table_mtime;
+    off_t journal_offset;              //!< how far into the journal the entries reflect
+    int journal_records;               //!< records replayed from the journal since the table was loaded
+    char loaded;
+    char sparse;                       //!< whether the totals count idle blobs by the blocks they take on disk
+} blobstore_index;
+
+//! Metadata of a blob as kept in its packed .meta record, which holds one field per metadata path
+//! type as '<suffix> <length>\n<length bytes>\n', with fields that are empty left out altogether
+typedef struct _blockblob_metadata {
+    char *val[BLOCKBLOB_PATH_TOTAL];   //!< contents of each field, always NUL-terminated, or NULL if the field is empty
+    int len[BLOCKBLOB_PATH_TOTAL];     //!< length of each field, without the terminator
+} blockblob_metadata;
+
+//! Data usage of a thin pool, as reported by the device mapper
+typedef struct _thin_pool_status {
+    unsigned long long data_blocks_used;    //!< pool blocks provisioned to thin devices
+    unsigned long long data_blocks_total;   //!< pool blocks in all
+    boolean found;                     //!< whether the status of the pool was found
+} thin_pool_status;
+
+//! A blob taken away from everyone else by locking it, so that it can be purged without the store lock
+typedef struct _blockblob_claim {
+    char id[BLOBSTORE_MAX_PATH];       //!< ID of the blob
+    int fd;                            //!< its open and locked .lock file
+    unsigned long long size_bytes;     //!< its size, as recorded in the index
+    unsigned long long limit_blocks;   //!< blocks it counted for toward the limit, as recorded in the index
+} blockblob_claim;
+
+//! Blobs found consistent by the last fsck, as sorted '<id> <metadata state>' lines
+typedef struct _fsck_record {
+    char **lines;                      //!< the lines, sorted
+    int size;                          //!< number of lines
+} fsck_record;
+
+//! Blobs shared by the threads of an fsck that check their devices
+typedef struct _fsck_work {
+    blockblob **bbs;                   //!< all blobs of the store
+    int *errors;                       //!< per blob, number of device problems found, or -1 for blobs that need no check
+    char **states;                     //!< per blob, state of its metadata before the check, or NULL if it has no packed metadata
+    int size;                          //!< number of blobs
+    int next;                          //!< next blob to be taken by a thread
+    pthread_mutex_t mutex;             //!< guards 'next'
+} fsck_work;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -282,13 +423,18 @@ static const char *blobstore_metadata_suffixes[] = {
     "sig",
     "refs",
     "hollow",
+    "thin",
+    "meta",
 };
 
 static void (*err_fn) (const char *msg) = NULL;
 static unsigned char _do_print_errors = 1;
 static unsigned char _do_print_trace = 1;
 static pthread_mutex_t _blobstore_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< process-global mutex
+static pthread_mutex_t _blobstore_stats_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards the lock wait statistics of all stores
 static blobstore_filelock *locks_list = NULL;   //!< process-global LL head @TODO replace this with a hash table
+static pthread_once_t fsck_pool_once = PTHREAD_ONCE_INIT;   //!< creates fsck_pool on first use
+static thread_pool *fsck_pool = NULL;  //!< workers checking the devices of blobs, or NULL if it could not be created
 
 //! @{
 //! @name debugging counters
@@ -356,6 +502,14 @@ static int buf_to_fd(int fd, const char *buf, int size_buf);
 static int read_store_metadata(blobstore * bs);
 static int write_store_metadata(blobstore * bs);
 static int set_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char *path, size_t path_size);
+static int is_packed_metadata_path(blockblob_path_t path_t);
+static void free_packed_metadata(blockblob_metadata * m);
+static int parse_packed_metadata(const char *buf, int buf_len, blockblob_metadata * m);
+static int fd_to_packed_metadata(int fd, blockblob_metadata * m);
+static int packed_metadata_to_fd(int fd, const blockblob_metadata * m);
+static int read_legacy_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **val);
+static int get_blockblob_metadata(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **val);
+static int put_blockblob_metadata(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, const char *val, int val_len);
 static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, const char *str);
 static int read_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char *str, int str_size);
 static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **array, int array_size);
@@ -365,23 +519,81 @@ static int typeof_blockblob_metadata_path(const blobstore * bs, const char *path
 static int delete_blockblob_files(const blobstore * bs, const char *bb_id);
 static int ensure_blockblob_metadata_path(const blobstore * bs, const char *bb_id);
 static void free_bbs(blockblob * bbs);
+static unsigned int check_relations(const blobstore * bs, const char *bb_id);
 static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec);
 static void set_device_path(blockblob * bb);
+static int is_store_file(const char *name);
+static unsigned long long get_mapped_bytes(const blobstore * bs, const char *bb_id);
 static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid);
+static unsigned int index_hash(const char *id);
+static blobstore_index_entry *index_find(blobstore_index * idx, const char *id, int add);
+static void index_clear(blobstore_index * idx);
+static void index_heap_swap(blobstore_index * idx, int i, int j);
+static void index_heap_fix(blobstore_index * idx, int pos);
+static void index_heap_insert(blobstore_index * idx, blobstore_index_entry * e);
+static void index_heap_remove(blobstore_index * idx, blobstore_index_entry * e);
+static unsigned long long blob_limit_blocks(int sparse, unsigned long long size_bytes, unsigned long long blocks_allocated, unsigned int in_use, int is_opened);
+static unsigned long long index_limit_blocks(const blobstore_index * idx, const blobstore_index_entry * e, int is_opened);
+static void index_account(blobstore_index * idx, const blobstore_index_entry * e, int sign);
+static void index_remove(blobstore_index * idx, blobstore_index_entry * e);
+static int index_apply(blobstore_index * idx, char *record);
+static int index_replay(blobstore_index * idx, int fd, off_t * offset, const char *header);
+static pid_t get_lock_owner(const blobstore * bs, const char *bb_id);
+static int index_format(const blobstore * bs, const char *bb_id, char *record, int record_size);
+static void index_invalidate(const blobstore * bs);
+static int index_record(const blobstore * bs, const char *bb_id);
+static int index_write_table(blobstore * bs, int journal_fd);
+static int index_rebuild(blobstore * bs);
+static int index_compact(blobstore * bs);
+static int index_sync(blobstore * bs);
+static void index_free(blobstore * bs);
+static int index_is_opened(const blobstore_index_entry * e);
+static void index_usage(blobstore * bs, const blockblob * bb_to_avoid, int exact, long long *blocks_locked, long long *blocks_unlocked);
+static int claim_blob(blobstore * bs, const char *bb_id, blockblob_claim * claim);
+static void release_claim(blobstore * bs, blockblob_claim * claim);
+static long long purge_index_lru(blobstore * bs, long long need_blocks, blockblob_claim * claims, int *claims_size);
+static long long purge_index_lru_unlocked(blobstore * bs, long long target_blocks, long long timeout_usec);
 static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid);
 static int compare_bbs(const void *bb1, const void *bb2);
 static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks);
 static int get_stale_refs(const blockblob * bb, char ***refs);
 static int loop_remove(blobstore * bs, const char *bb_id);
+#ifdef HAVE_LIBDEVMAPPER
+static int dm_lib_usable(void);
+static int dm_lib_run(int type, const char *dev_name, uint32_t * cookie, struct dm_info *info);
+static int dm_lib_create_devices(char *dev_names[], char *dm_tables[], int size, int *created);
+static int dm_lib_delete_devices(char *dev_names[], int size);
+#endif /* HAVE_LIBDEVMAPPER */
+static void account_lock_wait(blobstore_lock_stats * stats, long long started, int acquired);
 static int dm_suspend_resume(const char *dev_name);
 static int dm_check_device(const char *dev_name);
 static int dm_delete_device(const char *dev_name);
 static int dm_delete_devices(char *dev_names[], int size);
 static int dm_create_devices(char *dev_names[], char *dm_tables[], int size);
 static char *dm_get_zero(void);
-static int blockblob_check(const blockblob * bb);
-static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force);
+static int dm_message_device(const char *dev_name, const char *verb, const char *arg);
+static int thin_pool_parse_status(const char *line, void *data);
+static int thin_pool_get_status(const char *pool_name, thin_pool_status * status);
+static void thin_pool_name(const blobstore * bs, char *name, int name_size);
+static long long thin_pool_attach_file(const char *path, long long size_bytes, char *lodev, int lodev_size);
+static int thin_pool_ensure(const blobstore * bs, char *pool_name, int pool_name_size, int *new_thin_id);
+static int thin_pool_delete_ids(const blobstore * bs, char **ids, int ids_size);
+static void thin_pool_destroy(const blobstore * bs);
+static int blockblob_check(const blockblob * bb, int check_devices);
+static unsigned int fsck_checksum(const char *buf, int len);
+static int fsck_blob_state(const blobstore * bs, const char *bb_id, char *state, int state_size);
+static void fsck_get_boot_id(char *boot_id, int boot_id_size);
+static void fsck_load_record(const blobstore * bs, const char *boot_id, fsck_record * record);
+static int fsck_compare_lines(const void *a, const void *b);
+static int fsck_is_recorded(const fsck_record * record, const char *line);
+static void fsck_free_record(fsck_record * record);
+static void fsck_save_record(blobstore * bs, const char *boot_id, const fsck_work * work, const char *condemned);
+static void fsck_pool_init(void);
+static void *fsck_worker(void *arg);
+static void fsck_check_devices(fsck_work * work);
+static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force, char have_store_lock);
 static int verify_bb(const blockblob * bb, unsigned long long min_size_bytes);
+static int clone_blockblob(blockblob * bb, const blockmap * map, unsigned int map_size);
 
 #ifdef _UNIT_TEST
 static void _fill_blob(blockblob * bb, char c, int use_file);
@@ -398,6 +610,17 @@ static int do_blobstore_test(const char *base, const char *name, blobstore_forma
 static void *competitor_function(void *ptr);
 static void *thread_function(void *ptr);
 static void dummy_err_fn(const char *msg);
+#ifdef _BENCHMARK
+static long long bench_usec(void);
+static void bench_add(bench_samples * s, long long usec, int ok);
+static void bench_merge(bench_samples * to, bench_samples * from);
+static int bench_compare(const void *a, const void *b);
+static void bench_report(FILE * out, const char *op, const char *config, int threads, bench_samples * s);
+static void *bench_open_close(void *ptr);
+static int bench_store(FILE * out, const char *base, blobstore_snapshot_t snapshot, const char *snapshot_name, int count, const int *threads, int threads_len);
+static int bench_parse_list(const char *list, int *values, int size);
+static int do_benchmark(const char *base, int argc, char **argv);
+#endif /* _BENCHMARK */
 #endif /* _UNIT_TEST */
 
 #ifdef _EUCA_BLOBS
@@ -976,7 +1199,7 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
 {
     short l_type;
     int o_flags = 0;
-    long long started = time_usec();
+    long long started = mono_time_usec();
     long long deadline = started + timeout_usec;
 
     // verify the flags and, based on them,
@@ -1113,7 +1336,7 @@ static int open_and_lock(const char *path, int flags, long long timeout_usec, mo
                 goto error;
             }
         }
-        long long now = time_usec();
+        long long now = mono_time_usec();
         if (timeout_usec != BLOBSTORE_NO_TIMEOUT && now >= deadline) {  // we timed out waiting for the lock
             ERR(BLOBSTORE_ERROR_AGAIN, NULL);
             pthread_mutex_lock(&_blobstore_mutex);
@@ -1546,6 +1769,9 @@ write_metadata:
                     bs->limit_blocks = limit_blocks;
                 if (revocation_policy != BLOBSTORE_REVOCATION_ANY)
                     bs->revocation_policy = revocation_policy;
+                if ((snapshot_policy == BLOBSTORE_SNAPSHOT_DM || snapshot_policy == BLOBSTORE_SNAPSHOT_THIN)
+                    && (bs->snapshot_policy == BLOBSTORE_SNAPSHOT_DM || bs->snapshot_policy == BLOBSTORE_SNAPSHOT_THIN))
+                    bs->snapshot_policy = snapshot_policy;
                 write_store_metadata(bs);
             }
             close_and_unlock(bs->fd);  // try to close, thus giving up the exclusive lock
@@ -1578,6 +1804,15 @@ write_metadata:
         }
     }
     if (snapshot_policy != BLOBSTORE_SNAPSHOT_ANY && snapshot_policy != bs->snapshot_policy) {
+        // blobs snapshotted either way can live side by side, so one can switch between the two kinds of snapshots
+        if (!(flags & BLOBSTORE_FLAG_STRICT)
+            && (snapshot_policy == BLOBSTORE_SNAPSHOT_DM || snapshot_policy == BLOBSTORE_SNAPSHOT_THIN)
+            && (bs->snapshot_policy == BLOBSTORE_SNAPSHOT_DM || bs->snapshot_policy == BLOBSTORE_SNAPSHOT_THIN)) {
+            LOGINFO("switching blobstore %s to %s snapshots\n", bs->path, ((snapshot_policy == BLOBSTORE_SNAPSHOT_THIN) ? "thin" : "device mapper"));
+            write_flags = BLOBSTORE_FLAG_RDWR;
+            close_and_unlock(bs->fd);
+            goto write_metadata;
+        }
         ERR(BLOBSTORE_ERROR_INVAL, "'snapshot_policy' does not match existing blobstore");
         goto free;
     }
@@ -1623,6 +1858,7 @@ out:
 //!
 int blobstore_close(blobstore * bs)
 {
+    index_free(bs);
     EUCA_FREE(bs);
     return 0;
 }
@@ -1645,7 +1881,9 @@ int blobstore_lock(blobstore * bs, long long timeout_usec)
     snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_METADATA_FILE);
 
     LOGTRACE("{%u} blobstore_lock: called for %s\n", (unsigned int)pthread_self(), bs->path);
+    long long started = mono_time_usec();
     int fd = open_and_lock(meta_path, BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM);
+    account_lock_wait(&(bs->store_lock_stats), started, (fd != -1));
     if (fd != -1)
         bs->fd = fd;
     return fd;
@@ -1670,6 +1908,31 @@ int blobstore_unlock(blobstore * bs)
     return close_and_unlock(fd);
 }
 
+//!
+//! Adds a wait on a lock to the statistics kept for it
+//!
+//! @param[in] stats statistics of the store lock or of the blob locks of a store
+//! @param[in] started when the wait started, from mono_time_usec()
+//! @param[in] acquired whether the lock was obtained; if not, the wait counts as timed out only if that was the reason
+//!
+static void account_lock_wait(blobstore_lock_stats * stats, long long started, int acquired)
+{
+    long long waited = mono_time_usec() - started;
+
+    if (waited < 0)
+        waited = 0;                    // the clock was set back
+    pthread_mutex_lock(&_blobstore_stats_mutex);
+    if (acquired) {
+        stats->acquired++;
+    } else if (_blobstore_errno == BLOBSTORE_ERROR_AGAIN) {
+        stats->timed_out++;
+    }
+    stats->wait_usec += waited;
+    if ((unsigned long long)waited > stats->max_wait_usec)
+        stats->max_wait_usec = waited;
+    pthread_mutex_unlock(&_blobstore_stats_mutex);
+}
+
 //!
 //! If no outside references to store or blobs exist, and
 //! no blobs are protected, deletes the blobs, the store metadata,
@@ -1702,6 +1965,16 @@ int blobstore_delete(blobstore * bs)
     snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_METADATA_FILE);
     LOGINFO("removing blobstore metadata '%s'\n", meta_path);
     unlink(meta_path);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+    unlink(meta_path);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    unlink(meta_path);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_CONTENT_INDEX_FILE);
+    unlink(meta_path);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_FSCK_FILE);
+    unlink(meta_path);
+    thin_pool_destroy(bs);
+    index_free(bs);
     EUCA_FREE(bs);
 
     return EUCA_OK;
@@ -1774,6 +2047,12 @@ static int set_blockblob_metadata_path(blockblob_path_t path_t, const blobstore
     case BLOCKBLOB_PATH_HOLLOW:
         euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_HOLLOW], sizeof(name));
         break;
+    case BLOCKBLOB_PATH_THIN:
+        euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_THIN], sizeof(name));
+        break;
+    case BLOCKBLOB_PATH_META:
+        euca_strncpy(name, blobstore_metadata_suffixes[BLOCKBLOB_PATH_META], sizeof(name));
+        break;
     default:
         ERR(BLOBSTORE_ERROR_INVAL, "invalid path_t");
         return -1;
@@ -1794,6 +2073,371 @@ static int set_blockblob_metadata_path(blockblob_path_t path_t, const blobstore
     return 0;
 }
 
+//!
+//! Tells whether a metadata path type lives in the packed .meta record of a blob rather than
+//! in a file of its own. The blocks and the lock file always stay separate.
+//!
+//! @param[in] path_t
+//!
+//! @return TRUE if the type is packed or FALSE otherwise
+//!
+static int is_packed_metadata_path(blockblob_path_t path_t)
+{
+    return ((path_t >= BLOCKBLOB_PATH_DM) && (path_t < BLOCKBLOB_PATH_META));
+}
+
+//!
+//! Frees the field contents of a packed metadata record
+//!
+//! @param[in] m
+//!
+static void free_packed_metadata(blockblob_metadata * m)
+{
+    for (int i = 0; i < BLOCKBLOB_PATH_TOTAL; i++) {
+        EUCA_FREE(m->val[i]);
+        m->len[i] = 0;
+    }
+}
+
+//!
+//! Parses a packed metadata record. Fields with names that are not known are skipped and,
+//! should a field appear more than once, the last one wins.
+//!
+//! @param[in]  buf contents of the .meta file
+//! @param[in]  buf_len
+//! @param[out] m record to fill in, which must be zeroed by the caller
+//!
+//! @return 0 on success or -1 if the record is malformed or memory runs out
+//!
+static int parse_packed_metadata(const char *buf, int buf_len, blockblob_metadata * m)
+{
+    int i = 0;
+    int pos = 0;
+    int name_len = 0;
+    long len = 0;
+    char *end = NULL;
+    const char *sp = NULL;
+
+    while (pos < buf_len) {
+        if ((sp = memchr(buf + pos, ' ', buf_len - pos)) == NULL)
+            goto malformed;
+        name_len = sp - (buf + pos);
+
+        errno = 0;
+        len = strtol(sp + 1, &end, 10);
+        if (errno || (end == (sp + 1)) || (end >= (buf + buf_len)) || (*end != '\n') || (len < 0))
+            goto malformed;
+        pos = (end + 1) - buf;
+        if ((len > (buf_len - pos - 1)) || (buf[pos + len] != '\n'))
+            goto malformed;
+
+        for (i = BLOCKBLOB_PATH_DM; i < BLOCKBLOB_PATH_META; i++) {
+            if ((strlen(blobstore_metadata_suffixes[i]) == name_len) && !strncmp(blobstore_metadata_suffixes[i], sp - name_len, name_len))
+                break;
+        }
+        if ((i < BLOCKBLOB_PATH_META) && (len > 0)) {
+            EUCA_FREE(m->val[i]);
+            if ((m->val[i] = EUCA_ALLOC(len + 1, sizeof(char))) == NULL) {
+                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+                return -1;
+            }
+            memcpy(m->val[i], buf + pos, len);
+            m->val[i][len] = '\0';
+            m->len[i] = len;
+        }
+        pos += len + 1;
+    }
+    return 0;
+
+malformed:
+    ERR(BLOBSTORE_ERROR_INVAL, "malformed packed metadata record");
+    return -1;
+}
+
+//!
+//! Reads and parses the whole packed metadata record a descriptor is open on
+//!
+//! @param[in]  fd descriptor of the .meta file, locked by the caller
+//! @param[out] m record to fill in, which must be zeroed by the caller
+//!
+//! @return the size of the record file or -1 on error
+//!
+static int fd_to_packed_metadata(int fd, blockblob_metadata * m)
+{
+    int ret = 0;
+    ssize_t got = 0;
+    off_t pos = 0;
+    char *buf = NULL;
+    struct stat sb = { 0 };
+
+    if (fstat(fd, &sb) == -1) {
+        ERR(BLOBSTORE_ERROR_ACCES, "failed to stat metadata file");
+        return -1;
+    }
+    if (sb.st_size == 0)
+        return 0;
+    if (sb.st_size > BLOBSTORE_MAX_PACKED_METADATA) {
+        ERR(BLOBSTORE_ERROR_INVAL, "packed metadata record is too big");
+        return -1;
+    }
+
+    if ((buf = EUCA_ALLOC(sb.st_size, sizeof(char))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
+    }
+    while (pos < sb.st_size) {
+        if ((got = pread(fd, buf + pos, sb.st_size - pos, pos)) <= 0) {
+            if ((got == -1) && (errno == EINTR))
+                continue;
+            break;
+        }
+        pos += got;
+    }
+
+    if (pos != sb.st_size) {
+        ERR(BLOBSTORE_ERROR_NOENT, "failed to read metadata file");
+        ret = -1;
+    } else if (parse_packed_metadata(buf, sb.st_size, m) == -1) {
+        ret = -1;
+    } else {
+        ret = sb.st_size;
+    }
+    EUCA_FREE(buf);
+    return ret;
+}
+
+//!
+//! Writes a packed metadata record over the whole file a descriptor is open on
+//!
+//! @param[in] fd descriptor of the .meta file, write-locked by the caller
+//! @param[in] m
+//!
+//! @return 0 on success or -1 on error
+//!
+static int packed_metadata_to_fd(int fd, const blockblob_metadata * m)
+{
+    int i = 0;
+    int ret = 0;
+    int size = 0;
+    int len = 0;
+    ssize_t wrote = 0;
+    off_t pos = 0;
+    char *buf = NULL;
+
+    for (i = BLOCKBLOB_PATH_DM; i < BLOCKBLOB_PATH_META; i++) {
+        if (m->len[i] > 0)
+            size += strlen(blobstore_metadata_suffixes[i]) + m->len[i] + 24;
+    }
+    if ((buf = EUCA_ALLOC(size + 1, sizeof(char))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
+    }
+    for (i = BLOCKBLOB_PATH_DM; i < BLOCKBLOB_PATH_META; i++) {
+        if (m->len[i] > 0) {
+            len += snprintf(buf + len, size + 1 - len, "%s %d\n", blobstore_metadata_suffixes[i], m->len[i]);
+            memcpy(buf + len, m->val[i], m->len[i]);
+            len += m->len[i];
+            buf[len++] = '\n';
+        }
+    }
+
+    while (pos < len) {
+        if ((wrote = pwrite(fd, buf + pos, len - pos, pos)) <= 0) {
+            if ((wrote == -1) && (errno == EINTR))
+                continue;
+            break;
+        }
+        pos += wrote;
+    }
+    EUCA_FREE(buf);
+
+    if (pos != len) {
+        ERR(BLOBSTORE_ERROR_NOENT, "failed to write metadata file");
+        ret = -1;
+    } else if (ftruncate(fd, len) == -1) {
+        ERR(BLOBSTORE_ERROR_ACCES, "failed to truncate metadata file");
+        ret = -1;
+    }
+    return ret;
+}
+
+//!
+//! Reads a metadata file of a blob in the layout that predates the packed record. Nothing
+//! writes or locks these files anymore, they only get read until the blob is migrated, so
+//! they are read without taking the lock.
+//!
+//! @param[in]  path_t
+//! @param[in]  bs
+//! @param[in]  bb_id
+//! @param[out] val newly allocated and NUL-terminated contents of the file, NULL if it is empty
+//!
+//! @return the size of the file or -1 if it does not exist or could not be read
+//!
+static int read_legacy_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **val)
+{
+    int fd = -1;
+    int ret = 0;
+    ssize_t got = 0;
+    off_t pos = 0;
+    char path[PATH_MAX] = "";
+    struct stat sb = { 0 };
+
+    *val = NULL;
+    set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        ERR(BLOBSTORE_ERROR_NOENT, "blockblob metadata file does not exist");
+        return -1;
+    }
+
+    if (fstat(fd, &sb) == -1) {
+        ERR(BLOBSTORE_ERROR_ACCES, "failed to stat metadata file");
+        ret = -1;
+    } else if (sb.st_size > BLOBSTORE_MAX_PACKED_METADATA) {
+        ERR(BLOBSTORE_ERROR_INVAL, "metadata file is too big");
+        ret = -1;
+    } else if ((sb.st_size > 0) && ((*val = EUCA_ALLOC(sb.st_size + 1, sizeof(char))) == NULL)) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+    } else {
+        while (pos < sb.st_size) {
+            if ((got = read(fd, (*val) + pos, sb.st_size - pos)) <= 0) {
+                if ((got == -1) && (errno == EINTR))
+                    continue;
+                break;
+            }
+            pos += got;
+        }
+        if (pos != sb.st_size) {
+            ERR(BLOBSTORE_ERROR_NOENT, "failed to read metadata file");
+            ret = -1;
+        } else {
+            if (*val)
+                (*val)[pos] = '\0';
+            ret = pos;
+        }
+    }
+    close(fd);
+
+    if (ret == -1)
+        EUCA_FREE(*val);
+    return ret;
+}
+
+//!
+//! Gets one field of the metadata of a blob: from its packed record if it has one or else from
+//! the file the field was kept in before the record was introduced
+//!
+//! @param[in]  path_t one of the packed types
+//! @param[in]  bs
+//! @param[in]  bb_id
+//! @param[out] val newly allocated and NUL-terminated contents of the field, NULL if it is empty
+//!
+//! @return the length of the field (0 if it is empty) or -1 if the blob has no such metadata or on error
+//!
+static int get_blockblob_metadata(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char **val)
+{
+    int fd = -1;
+    int ret = 0;
+    int size = 0;
+    char path[PATH_MAX] = "";
+    struct stat sb = { 0 };
+    blockblob_metadata m = { {0} };
+
+    *val = NULL;
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_META, bs, bb_id, path, sizeof(path));
+    if ((stat(path, &sb) == -1) || (sb.st_size == 0))
+        return read_legacy_metadata_path(path_t, bs, bb_id, val);
+
+    if ((fd = open_and_lock(path, BLOBSTORE_FLAG_RDONLY, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1)
+        return -1;
+    size = fd_to_packed_metadata(fd, &m);
+    if (close_and_unlock(fd) != 0)
+        size = -1;                     // close_and_unlock should have set the error code
+
+    if (size == 0) {
+        // emptied since the stat() above, either by a rewrite or a migration in progress
+        ret = read_legacy_metadata_path(path_t, bs, bb_id, val);
+    } else if (size > 0) {
+        *val = m.val[path_t];
+        ret = m.len[path_t];
+        m.val[path_t] = NULL;
+    } else {
+        ret = -1;
+    }
+    free_packed_metadata(&m);
+    return ret;
+}
+
+//!
+//! Sets one field of the metadata of a blob, with a single rewrite of its packed record. The
+//! first time this happens for a blob that still has its metadata in separate files, every
+//! other field is carried over into the record and the old files are removed.
+//!
+//! @param[in] path_t one of the packed types
+//! @param[in] bs
+//! @param[in] bb_id
+//! @param[in] val new contents of the field, an empty one removes the field
+//! @param[in] val_len
+//!
+//! @return 0 for success or -1 for error
+//!
+static int put_blockblob_metadata(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, const char *val, int val_len)
+{
+    int i = 0;
+    int fd = -1;
+    int ret = 0;
+    int size = 0;
+    int migrating = FALSE;
+    char path[PATH_MAX] = "";
+    char legacy_path[PATH_MAX] = "";
+    struct stat sb = { 0 };
+    blockblob_metadata m = { {0} };
+
+    // _CREAT would truncate a record someone else may be reading, so only use it when there is none
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_META, bs, bb_id, path, sizeof(path));
+    if (stat(path, &sb) == -1)
+        fd = open_and_lock(path, BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM);
+    if ((fd == -1) && ((fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1))
+        return -1;
+
+    if ((size = fd_to_packed_metadata(fd, &m)) == 0) {
+        migrating = TRUE;
+        for (i = BLOCKBLOB_PATH_DM; i < BLOCKBLOB_PATH_META; i++) {
+            set_blockblob_metadata_path(i, bs, bb_id, legacy_path, sizeof(legacy_path));
+            if ((i == path_t) || (access(legacy_path, F_OK) == -1))
+                continue;              // most blobs never had most of the files, so do not complain about them
+            if ((m.len[i] = read_legacy_metadata_path(i, bs, bb_id, &(m.val[i]))) < 0)
+                m.len[i] = 0;
+        }
+    }
+
+    if (size >= 0) {
+        EUCA_FREE(m.val[path_t]);
+        m.len[path_t] = 0;
+        if ((val_len > 0) && ((m.val[path_t] = strndup(val, val_len)) == NULL)) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            ret = -1;
+        } else {
+            m.len[path_t] = val_len;
+            ret = packed_metadata_to_fd(fd, &m);
+        }
+    } else {
+        ret = -1;
+    }
+
+    if (close_and_unlock(fd) != 0)
+        ret = -1;                      // close_and_unlock should have set the error code
+    free_packed_metadata(&m);
+
+    if (migrating && (ret == 0)) {
+        for (i = BLOCKBLOB_PATH_DM; i < BLOCKBLOB_PATH_META; i++) {
+            set_blockblob_metadata_path(i, bs, bb_id, legacy_path, sizeof(legacy_path));
+            unlink(legacy_path);
+        }
+    }
+    return ret;
+}
+
 //!
 //! Write string 'str' into a specific metadata file (based on 'path_t') of blob 'bb_id'
 //!
@@ -1812,6 +2456,10 @@ static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstor
 {
     int ret = 0;
     char path[PATH_MAX];
+
+    if (is_packed_metadata_path(path_t))
+        return put_blockblob_metadata(path_t, bs, bb_id, str, strlen(str));
+
     set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
 
     int fd = open_and_lock(path,
@@ -1851,6 +2499,25 @@ static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstor
 static int read_blockblob_metadata_path(blockblob_path_t path_t, const blobstore * bs, const char *bb_id, char *str, int str_size)
 {
     char path[PATH_MAX];
+    char *val = NULL;
+
+    if (is_packed_metadata_path(path_t)) {
+        int len = get_blockblob_metadata(path_t, bs, bb_id, &val);
+        if (len > str_size) {
+            ERR(BLOBSTORE_ERROR_NOENT, "failed to read metadata file");
+            len = -1;
+        } else if (len == 0) {
+            ERR(BLOBSTORE_ERROR_NOENT, "blockblob metadata size is too small");
+            len = -1;
+        } else if (len > 0) {
+            memcpy(str, val, len);
+            if (len < str_size)
+                str[len] = '\0';
+        }
+        EUCA_FREE(val);
+        return len;
+    }
+
     set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
 
     int fd = open_and_lock(path,
@@ -1896,6 +2563,24 @@ static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const bl
     int dataLen = 0;
     unsigned int openFlags = (BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_TRUNC | BLOBSTORE_FLAG_RDWR);
     char path[EUCA_MAX_PATH] = "";
+    char *buf = NULL;
+
+    if (is_packed_metadata_path(path_t)) {
+        // join the lines in memory so that the whole array goes into the record in one write
+        for (i = 0; i < array_size; i++)
+            dataLen += strlen(array[i]) + 1;
+        if ((buf = EUCA_ALLOC(dataLen + 1, sizeof(char))) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            return (-1);
+        }
+        buf[0] = '\0';
+        for (i = 0, dataLen = 0; i < array_size; i++)
+            dataLen += sprintf(buf + dataLen, "%s\n", array[i]);
+        if ((ret = put_blockblob_metadata(path_t, bs, bb_id, buf, dataLen)) == -1)
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        EUCA_FREE(buf);
+        return (ret);
+    }
 
     set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
     if ((fd = open_and_lock(path, openFlags, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1) {
@@ -2024,6 +2709,52 @@ static int read_array_blockblob_metadata_path(blockblob_path_t path_t, const blo
     char *line = NULL;
     char **bigger_lines = NULL;
     char path[EUCA_MAX_PATH] = "";
+    char *buf = NULL;
+    char *start = NULL;
+    char *end = NULL;
+    int len = 0;
+
+    if (is_packed_metadata_path(path_t)) {
+        // the field is read in one go, so split it into lines in memory
+        if ((len = get_blockblob_metadata(path_t, bs, bb_id, &buf)) == -1) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            *array = NULL;
+            *array_size = 0;
+            return 0;
+        }
+
+        for (i = 0, start = buf; (start != NULL) && (start < (buf + len)); i++) {
+            if ((end = memchr(start, '\n', (buf + len) - start)) == NULL)
+                end = buf + len;
+            if (end == start)          // an empty line ends the array, as with get_line_desc()
+                break;
+
+            if ((bigger_lines = EUCA_REALLOC(lines, (i + 1), sizeof(char *))) == NULL) {
+                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+                ret = -1;
+                break;
+            }
+            lines = bigger_lines;
+            if ((lines[i] = strndup(start, end - start)) == NULL) {
+                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+                ret = -1;
+                break;
+            }
+            start = end + 1;
+        }
+        EUCA_FREE(buf);
+
+        if (ret == -1) {
+            for (j = 0; j < i; j++)
+                EUCA_FREE(lines[j]);
+            EUCA_FREE(lines);
+            return (ret);
+        }
+
+        *array = lines;
+        *array_size = i;
+        return (0);
+    }
 
     set_blockblob_metadata_path(path_t, bs, bb_id, path, sizeof(path));
 
@@ -2146,6 +2877,8 @@ static int update_entry_blockblob_metadata_path(blockblob_path_t path_t, const b
     // save new entries into the metadata file
     if (write_array_blockblob_metadata_path(path_t, bs, bb_id, entries, entries_size) == -1) {
         ret = -1;
+    } else {
+        index_record(bs, bb_id);       // references of the blob changed
     }
 
 cleanup:
@@ -2250,6 +2983,9 @@ static int delete_blockblob_files(const blobstore * bs, const char *bb_id)
         }
     }
 
+    if (count > 0) {
+        index_record(bs, bb_id);       // records that the blob is gone
+    }
     return count;
 }
 
@@ -2291,40 +3027,20 @@ static void free_bbs(blockblob * bbs)
 }
 
 //!
-//!
+//! Finds out whether other blobs depend on this one (it has a .refs file) or whether it
+//! depends on others (it has a .deps or a .dm file)
 //!
 //! @param[in] bs
 //! @param[in] bb_id
-//! @param[in] timeout_usec
 //!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return BLOCKBLOB_STATUS_MAPPED and/or BLOCKBLOB_STATUS_BACKED, or 0 if neither
 //!
-static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec)
+static unsigned int check_relations(const blobstore * bs, const char *bb_id)
 {
     unsigned int in_use = 0;
     char path[PATH_MAX];
 
-    // determine the path of the .lock file for this blob
-    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb_id, path, sizeof(path));
-
     _err_off();                        // do not complain if metadata files do not exist
-    int fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM);   // try opening to see what happens
-    if (fd != -1) {
-        struct stat s;
-        if (fstat(fd, &s) == 0) {
-            if (s.st_size > 0) {       // lock file was not truncated before being released => file not properly closed
-                in_use |= BLOCKBLOB_STATUS_ABANDONED;
-            }
-        }
-        close_and_unlock(fd);
-    } else {
-        in_use |= BLOCKBLOB_STATUS_OPENED;  //! @TODO check if open failed for other reason?
-    }
-
     if (read_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb_id, path, sizeof(path)) > 0) {
         in_use |= BLOCKBLOB_STATUS_MAPPED;
     }
@@ -2341,6 +3057,46 @@ static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long ti
     return in_use;
 }
 
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//! @param[in] timeout_usec
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec)
+{
+    unsigned int in_use = 0;
+    char path[PATH_MAX];
+
+    // determine the path of the .lock file for this blob
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb_id, path, sizeof(path));
+
+    _err_off();                        // do not complain if metadata files do not exist
+    int fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM);   // try opening to see what happens
+    if (fd != -1) {
+        struct stat s;
+        if (fstat(fd, &s) == 0) {
+            if (s.st_size > 0) {       // lock file was not truncated before being released => file not properly closed
+                in_use |= BLOCKBLOB_STATUS_ABANDONED;
+            }
+        }
+        close_and_unlock(fd);
+    } else {
+        in_use |= BLOCKBLOB_STATUS_OPENED;  //! @TODO check if open failed for other reason?
+    }
+    _err_on();
+
+    in_use |= check_relations(bs, bb_id);
+    return in_use;
+}
+
 //!
 //!
 //!
@@ -2375,6 +3131,60 @@ static void set_device_path(blockblob * bb)
     }
 }
 
+//!
+//! Tells the files kept by the store itself, at the top of its directory, from the blob files
+//!
+//! @param[in] name name of the directory entry
+//!
+//! @return 1 if this is the store metadata file or one of the blob index files, 0 otherwise
+//!
+static int is_store_file(const char *name)
+{
+    return (!strcmp(BLOBSTORE_METADATA_FILE, name) || !strcmp(BLOBSTORE_INDEX_FILE, name) || !strcmp(BLOBSTORE_INDEX_TMP_FILE, name)
+            || !strcmp(BLOBSTORE_JOURNAL_FILE, name) || !strcmp(BLOBSTORE_POOL_FILE, name) || !strcmp(BLOBSTORE_POOL_DATA_FILE, name)
+            || !strcmp(BLOBSTORE_POOL_META_FILE, name) || !strcmp(BLOBSTORE_CONTENT_INDEX_FILE, name)
+            || !strcmp(BLOBSTORE_FSCK_FILE, name) || !strcmp(BLOBSTORE_FSCK_TMP_FILE, name));
+}
+
+//!
+//! Adds up the blocks that a blob maps from other blobs, according to its .deps file, since
+//! those do not take up space in this blob
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return the number of mapped bytes, 0 if there are none
+//!
+static unsigned long long get_mapped_bytes(const blobstore * bs, const char *bb_id)
+{
+    unsigned long long mapped_bytes = 0;
+    char **array = NULL;
+    int array_size = 0;
+
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bs, bb_id, &array, &array_size) != -1) {
+        for (int i = 0; i < array_size; i++) {
+            char *rel_type = NULL;
+            char *len_blocks = NULL;
+
+            strtok(array[i], " ");     // store path
+            strtok(NULL, " ");         // blob id
+            rel_type = strtok(NULL, " ");
+            strtok(NULL, " ");         // start block
+            len_blocks = strtok(NULL, " ");
+            if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
+                mapped_bytes += strtoull(len_blocks, NULL, 0) * 512LL;
+            }
+        }
+    }
+
+    if (array) {
+        for (int i = 0; i < array_size; i++)
+            EUCA_FREE(array[i]);
+        EUCA_FREE(array);
+    }
+    return mapped_bytes;
+}
+
 //!
 //! Given a directory that may contain both blobstore files and
 //! non-blobstore files (e.g., instance metadata and soft-links),
@@ -2399,7 +3209,7 @@ int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path)
     while ((dir_entry = readdir(dir)) != NULL) {
         char *entry_name = dir_entry->d_name;
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name))
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || is_store_file(entry_name))
             continue;                  // ignore known unrelated files
 
         // get the path of the directory item
@@ -2446,7 +3256,7 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
     while ((dir_entry = readdir(dir)) != NULL) {
         char *entry_name = dir_entry->d_name;
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name))
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || is_store_file(entry_name))
             continue;                  // ignore known unrelated files
 
         // get the path of the directory item
@@ -2499,59 +3309,1190 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
         if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bb->store, bb->id, buf, sizeof(buf)) != -1) {
             bb->is_hollow = TRUE;
         }
-        // if there is a .refs file, subtract the mapped blocks, if any, from the size
-        char **array = NULL;
-        int array_size = 0;
-        if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) != -1) {
-            for (int i = 0; i < array_size; i++) {
-                char *store_path = NULL;
-                char *blob_id = NULL;
-                char *rel_type = NULL;
-                char *start_block = NULL;
-                char *len_blocks = NULL;
-
-                store_path = strtok(array[i], " ");
-                blob_id = strtok(NULL, " ");
-                rel_type = strtok(NULL, " ");
-                start_block = strtok(NULL, " ");
-                len_blocks = strtok(NULL, " ");
-                if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
-                    bb->size_bytes -= strtoull(len_blocks, NULL, 0) * 512LL;
-                }
+        // if there is a .deps file, subtract the mapped blocks, if any, from the size
+        bb->size_bytes -= get_mapped_bytes(bs, bb->id);
+    }
+
+free:
+    closedir(dir);
+    return tail_bb;
+}
+
+//!
+//! Hashes a blob ID for the in-memory blob index (FNV-1a)
+//!
+//! @param[in] id
+//!
+//! @return the hash of the ID
+//!
+static unsigned int index_hash(const char *id)
+{
+    unsigned int h = 2166136261U;
+
+    for (const unsigned char *p = (const unsigned char *)id; *p; p++) {
+        h ^= *p;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+//!
+//! Looks up a blob in the in-memory index, optionally adding an entry for it
+//!
+//! @param[in] idx
+//! @param[in] id
+//! @param[in] add set to 1 to add an empty entry for the blob if it is not in the index
+//!
+//! @return a pointer to the entry or NULL if it is not there (or could not be added)
+//!
+static blobstore_index_entry *index_find(blobstore_index * idx, const char *id, int add)
+{
+    int i = 0;
+    int free_slot = -1;
+    unsigned int mask = 0;
+    blobstore_index_entry *e = NULL;
+
+    if (idx->slots_size) {
+        mask = idx->slots_size - 1;
+        for (i = index_hash(id) & mask; idx->slots[i]; i = (i + 1) & mask) {
+            e = &(idx->entries[idx->slots[i] - 1]);
+            if (e->id == NULL) {
+                if (free_slot == -1)
+                    free_slot = i;     // removed entry, which we can reuse when adding
+            } else if (!strcmp(e->id, id)) {
+                return e;
+            }
+        }
+        if (free_slot == -1)
+            free_slot = i;
+    }
+
+    if (!add)
+        return NULL;
+
+    if (free_slot != -1 && idx->slots[free_slot]) {
+        e = &(idx->entries[idx->slots[free_slot] - 1]);
+    } else {
+        if (idx->entries_size == idx->entries_max) {
+            int entries_max = (idx->entries_max) ? (idx->entries_max * 2) : 1024;
+            blobstore_index_entry *entries = EUCA_REALLOC(idx->entries, entries_max, sizeof(blobstore_index_entry));
+            int *heap = EUCA_REALLOC(idx->heap, entries_max, sizeof(int));
+            int *slots = EUCA_ZALLOC(entries_max * 2, sizeof(int));
+            if (entries)
+                idx->entries = entries;
+            if (heap)
+                idx->heap = heap;
+            if (!entries || !heap || !slots) {
+                EUCA_FREE(slots);
+                return NULL;
+            }
+
+            // rehash the blobs that are there, dropping the removed entries from the hash
+            EUCA_FREE(idx->slots);
+            idx->slots = slots;
+            idx->slots_size = entries_max * 2;
+            idx->entries_max = entries_max;
+            mask = idx->slots_size - 1;
+            for (int j = 0; j < idx->entries_size; j++) {
+                if (idx->entries[j].id) {
+                    for (i = index_hash(idx->entries[j].id) & mask; idx->slots[i]; i = (i + 1) & mask) ;
+                    idx->slots[i] = j + 1;
+                }
+            }
+            for (free_slot = index_hash(id) & mask; idx->slots[free_slot]; free_slot = (free_slot + 1) & mask) ;
+        }
+        e = &(idx->entries[idx->entries_size++]);
+        idx->slots[free_slot] = idx->entries_size;
+    }
+
+    memset(e, 0, sizeof(blobstore_index_entry));
+    e->heap_pos = -1;
+    if ((e->id = strdup(id)) == NULL)
+        return NULL;
+    idx->live++;
+    return e;
+}
+
+//!
+//! Empties the in-memory index, keeping the allocated arrays around
+//!
+//! @param[in] idx
+//!
+static void index_clear(blobstore_index * idx)
+{
+    for (int i = 0; i < idx->entries_size; i++) {
+        EUCA_FREE(idx->entries[i].id);
+        EUCA_FREE(idx->entries[i].device_path);
+        EUCA_FREE(idx->entries[i].dm_name);
+    }
+    if (idx->slots)
+        memset(idx->slots, 0, idx->slots_size * sizeof(int));
+    idx->entries_size = 0;
+    idx->live = 0;
+    idx->heap_size = 0;
+    idx->blocks_used = 0;
+    idx->blocks_opened = 0;
+    idx->journal_offset = 0;
+    idx->journal_records = 0;
+    idx->loaded = 0;
+}
+
+//!
+//! Swaps two positions of the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] i
+//! @param[in] j
+//!
+static void index_heap_swap(blobstore_index * idx, int i, int j)
+{
+    int t = idx->heap[i];
+
+    idx->heap[i] = idx->heap[j];
+    idx->heap[j] = t;
+    idx->entries[idx->heap[i]].heap_pos = i;
+    idx->entries[idx->heap[j]].heap_pos = j;
+}
+
+//!
+//! Moves the entry at a position of the LRU heap up or down until the heap is ordered again
+//!
+//! @param[in] idx
+//! @param[in] pos
+//!
+static void index_heap_fix(blobstore_index * idx, int pos)
+{
+#define HEAP_KEY(_pos)  (idx->entries[idx->heap[(_pos)]].last_modified)
+    int min = 0;
+
+    while (pos > 0 && HEAP_KEY(pos) < HEAP_KEY((pos - 1) / 2)) {
+        index_heap_swap(idx, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+
+    for (;;) {
+        min = pos;
+        if ((2 * pos + 1) < idx->heap_size && HEAP_KEY(2 * pos + 1) < HEAP_KEY(min))
+            min = 2 * pos + 1;
+        if ((2 * pos + 2) < idx->heap_size && HEAP_KEY(2 * pos + 2) < HEAP_KEY(min))
+            min = 2 * pos + 2;
+        if (min == pos)
+            break;
+        index_heap_swap(idx, pos, min);
+        pos = min;
+    }
+#undef HEAP_KEY
+}
+
+//!
+//! Adds an entry to the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] e
+//!
+static void index_heap_insert(blobstore_index * idx, blobstore_index_entry * e)
+{
+    e->heap_pos = idx->heap_size++;
+    idx->heap[e->heap_pos] = e - idx->entries;
+    index_heap_fix(idx, e->heap_pos);
+}
+
+//!
+//! Takes an entry out of the LRU heap
+//!
+//! @param[in] idx
+//! @param[in] e
+//!
+static void index_heap_remove(blobstore_index * idx, blobstore_index_entry * e)
+{
+    int pos = e->heap_pos;
+
+    if (pos < 0)
+        return;
+    idx->heap_size--;
+    if (pos != idx->heap_size) {
+        index_heap_swap(idx, pos, idx->heap_size);
+        index_heap_fix(idx, pos);
+    }
+    e->heap_pos = -1;
+}
+
+//!
+//! Adds the blocks of an entry to the running totals of the index, or takes them out
+//!
+//! @param[in] idx
+//! @param[in] e
+//! @param[in] sign 1 to add the entry or -1 to take it out
+//!
+static void index_account(blobstore_index * idx, const blobstore_index_entry * e, int sign)
+{
+    unsigned long long size_blocks = index_limit_blocks(idx, e, (e->opener > 0));
+
+    if (sign < 0) {
+        idx->blocks_used -= size_blocks;
+        if (e->opener > 0)
+            idx->blocks_opened -= size_blocks;
+    } else {
+        idx->blocks_used += size_blocks;
+        if (e->opener > 0)
+            idx->blocks_opened += size_blocks;
+    }
+}
+
+//!
+//! Tells how many blocks a blob counts for toward the limit of the store, which is its whole
+//! size unless the store counts blobs by the blocks they take on disk. Even then, a blob that
+//! is open may be written to and one that is related to others has devices through which it
+//! may be, so only the blobs that are neither count for less than their size.
+//!
+//! @param[in] sparse set to TRUE if the store counts blobs by the blocks they take on disk
+//! @param[in] size_bytes
+//! @param[in] blocks_allocated
+//! @param[in] in_use BLOCKBLOB_STATUS_MAPPED and BLOCKBLOB_STATUS_BACKED are looked at
+//! @param[in] is_opened
+//!
+//! @return the number of blocks
+//!
+static unsigned long long blob_limit_blocks(int sparse, unsigned long long size_bytes, unsigned long long blocks_allocated, unsigned int in_use, int is_opened)
+{
+    unsigned long long size_blocks = round_up_sec(size_bytes) / 512;
+
+    if (sparse && !is_opened && !(in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED)) && blocks_allocated < size_blocks)
+        return blocks_allocated;
+    return size_blocks;
+}
+
+//!
+//! Tells how many blocks the blob of an index entry counts for toward the limit of the store
+//!
+//! @param[in] idx
+//! @param[in] e
+//! @param[in] is_opened
+//!
+//! @return the number of blocks, which is 0 for hollow blobs
+//!
+static unsigned long long index_limit_blocks(const blobstore_index * idx, const blobstore_index_entry * e, int is_opened)
+{
+    if (e->is_hollow)
+        return 0;
+    return blob_limit_blocks(idx->sparse, e->size_bytes, e->blocks_allocated, e->in_use, is_opened);
+}
+
+//!
+//! Drops a blob from the in-memory index, leaving its entry to be reused
+//!
+//! @param[in] idx
+//! @param[in] e
+//!
+static void index_remove(blobstore_index * idx, blobstore_index_entry * e)
+{
+    index_account(idx, e, -1);
+    index_heap_remove(idx, e);
+    EUCA_FREE(e->id);
+    EUCA_FREE(e->device_path);
+    EUCA_FREE(e->dm_name);
+    idx->live--;
+}
+
+//!
+//! Applies one record of the table or the journal to the in-memory index. A record is either
+//! "+ id size_bytes blocks_allocated atime mtime is_hollow in_use opener device_path dm_name",
+//! describing the whole blob as it was when the record was written, or "- id" for a blob that
+//! is gone. Lines starting with '#' are comments.
+//!
+//! @param[in] idx
+//! @param[in] record one line, which gets tokenized in place
+//!
+//! @return 0 if the record was applied or skipped, -1 if it is malformed or out of memory
+//!
+static int index_apply(blobstore_index * idx, char *record)
+{
+    char *saveptr = NULL;
+    char *op = NULL;
+    char *id = NULL;
+    char *field[8] = { NULL };
+    blobstore_index_entry *e = NULL;
+
+    if (record[0] == '#' || record[0] == '\0')
+        return 0;
+
+    op = strtok_r(record, " \n", &saveptr);
+    id = strtok_r(NULL, " \n", &saveptr);
+    if (op == NULL || id == NULL)
+        return -1;
+
+    if (!strcmp(op, "-")) {
+        if ((e = index_find(idx, id, 0)) != NULL) {
+            index_remove(idx, e);
+        }
+        return 0;
+    }
+
+    if (strcmp(op, "+"))
+        return -1;
+    for (int i = 0; i < 8; i++) {
+        if ((field[i] = strtok_r(NULL, " \n", &saveptr)) == NULL)
+            return -1;
+    }
+
+    if ((e = index_find(idx, id, 1)) == NULL)
+        return -1;
+    index_account(idx, e, -1);         // a new entry is all zeroes, so this is harmless for it
+    e->size_bytes = strtoull(field[0], NULL, 10);
+    e->blocks_allocated = strtoull(field[1], NULL, 10);
+    e->last_accessed = (time_t) strtoll(field[2], NULL, 10);
+    e->last_modified = (time_t) strtoll(field[3], NULL, 10);
+    e->is_hollow = (unsigned char)atoi(field[4]);
+    e->in_use = (unsigned int)strtoul(field[5], NULL, 10);
+    e->opener = (pid_t) atoi(field[6]);
+    EUCA_FREE(e->device_path);
+    EUCA_FREE(e->dm_name);
+    e->device_path = strdup(strcmp(field[7], "-") ? field[7] : "");
+    if ((field[7] = strtok_r(NULL, " \n", &saveptr)) != NULL && strcmp(field[7], "-"))
+        e->dm_name = strdup(field[7]);
+
+    index_account(idx, e, 1);
+    if (e->heap_pos < 0) {
+        index_heap_insert(idx, e);
+    } else {
+        index_heap_fix(idx, e->heap_pos);
+    }
+    return 0;
+}
+
+//!
+//! Applies the complete records found in a file, starting at an offset, to the in-memory index
+//!
+//! @param[in]     idx
+//! @param[in]     fd the table or the journal file, which the caller has locked
+//! @param[in,out] offset where to start reading, moved past the last complete record applied
+//! @param[in]     header if not NULL, the text that the file must start with
+//!
+//! @return the number of records applied or -1 if the file could not be read or is corrupt
+//!
+static int index_replay(blobstore_index * idx, int fd, off_t * offset, const char *header)
+{
+    int records = 0;
+    char *buf = NULL;
+    char *line = NULL;
+    char *nl = NULL;
+    ssize_t len = 0;
+    ssize_t got = 0;
+    struct stat sb;
+
+    if (fstat(fd, &sb) == -1)
+        return -1;
+    if (sb.st_size < *offset)          // truncated under us
+        return -1;
+    if ((len = sb.st_size - *offset) == 0)
+        return 0;
+
+    if ((buf = EUCA_ALLOC(len + 1, sizeof(char))) == NULL)
+        return -1;
+    for (got = 0; got < len;) {
+        ssize_t n = pread(fd, buf + got, len - got, *offset + got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    buf[got] = '\0';
+
+    if (header && strncmp(buf, header, strlen(header))) {
+        EUCA_FREE(buf);
+        return -1;
+    }
+
+    for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+        *nl = '\0';
+        if (index_apply(idx, line)) {
+            LOGWARN("malformed record in blob index at offset %ld\n", (long)(*offset + (line - buf)));
+            EUCA_FREE(buf);
+            return -1;
+        }
+        records++;
+    }
+    *offset += (line - buf);           // a record that is still being written (without its newline) is picked up next time
+
+    EUCA_FREE(buf);
+    return records;
+}
+
+//!
+//! Finds out which process, if any, has a blob open from the contents of its lock file, which
+//! blockblob_open() fills with "pid/thread" and blockblob_close() truncates. The file is read
+//! without locking it, as whoever has the blob open holds that lock.
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return the pid of the opener, 0 if the blob is closed or -1 if the lock file holds something else
+//!
+static pid_t get_lock_owner(const blobstore * bs, const char *bb_id)
+{
+    int fd = -1;
+    ssize_t len = 0;
+    pid_t pid = 0;
+    char path[PATH_MAX] = "";
+    char buf[64] = "";
+
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb_id, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return 0;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return 0;
+
+    buf[len] = '\0';
+    pid = (pid_t) atoi(buf);
+    return ((pid > 0) ? pid : -1);
+}
+
+//!
+//! Looks at the files of a blob and writes the blob index record describing it, which says
+//! that the blob is gone if its content file no longer exists
+//!
+//! @param[in]  bs
+//! @param[in]  bb_id
+//! @param[out] record
+//! @param[in]  record_size
+//!
+//! @return the length of the record
+//!
+static int index_format(const blobstore * bs, const char *bb_id, char *record, int record_size)
+{
+    char buf[64] = "";
+    unsigned char is_hollow = FALSE;
+    unsigned int in_use = 0;
+    unsigned long long mapped_bytes = 0;
+    struct stat sb;
+    blockblob *bb = NULL;
+
+    if ((bb = EUCA_ZALLOC(1, sizeof(blockblob))) == NULL)
+        return -1;
+    bb->store = (blobstore *) bs;
+    euca_strncpy(bb->id, bb_id, sizeof(bb->id));
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb_id, bb->blocks_path, sizeof(bb->blocks_path));
+
+    if (stat(bb->blocks_path, &sb) == -1) {
+        EUCA_FREE(bb);
+        return snprintf(record, record_size, "- %s\n", bb_id);
+    }
+
+    set_device_path(bb);               // read .dm and .loopback and set bb->device_path accordingly
+    in_use = check_relations(bs, bb_id);
+    _err_off();                        // do not complain if metadata files do not exist
+    if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb_id, buf, sizeof(buf)) != -1) {
+        is_hollow = TRUE;
+    }
+    mapped_bytes = get_mapped_bytes(bs, bb_id);
+    _err_on();
+
+    snprintf(record, record_size, "+ %s %llu %llu %lld %lld %d %u %d %s %s\n", bb_id, (unsigned long long)sb.st_size - mapped_bytes,
+             (unsigned long long)sb.st_blocks, (long long)sb.st_atime, (long long)sb.st_mtime, is_hollow, in_use, (int)get_lock_owner(bs, bb_id),
+             (strlen(bb->device_path) ? bb->device_path : "-"), (strlen(bb->dm_name) ? bb->dm_name : "-"));
+    EUCA_FREE(bb);
+    return strlen(record);
+}
+
+//!
+//! Removes the table of the blob index, so that the next scan of the store rebuilds it from
+//! the files on disk. Used when a change could not be journaled.
+//!
+//! @param[in] bs
+//!
+static void index_invalidate(const blobstore * bs)
+{
+    char path[PATH_MAX] = "";
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+    LOGWARN("invalidating the blob index of %s, it will be rebuilt\n", bs->path);
+    unlink(path);
+}
+
+//!
+//! Appends the current state of a blob to the journal of the blob index. Since the state is
+//! gathered while holding the journal lock, records of the same blob always land in the
+//! journal in the order they were taken, no matter which process writes them.
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return 0 on success or -1 if the record could not be written, in which case the index is invalidated
+//!
+static int index_record(const blobstore * bs, const char *bb_id)
+{
+    int fd = -1;
+    int len = 0;
+    int ret = 0;
+    char path[PATH_MAX] = "";
+    char record[BLOBSTORE_INDEX_RECORD_SIZE] = "";
+
+    blobstore_error_t saved_errno = _blobstore_errno;   // looking at the blob files may set it
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, BLOBSTORE_FILE_PERM)) == -1) {
+        LOGWARN("failed to open blob index journal %s: %s\n", path, strerror(errno));
+        index_invalidate(bs);
+        return -1;
+    }
+
+    if (flock(fd, LOCK_EX) == -1) {
+        ret = -1;
+    } else if (((len = index_format(bs, bb_id, record, sizeof(record))) < 0) || (write(fd, record, len) != len)) {
+        ret = -1;
+    }
+    close(fd);                         // releases the lock, too
+    _blobstore_errno = saved_errno;
+
+    if (ret) {
+        LOGWARN("failed to record blob %s in the blob index journal %s\n", bb_id, path);
+        index_invalidate(bs);
+    }
+    return ret;
+}
+
+//!
+//! Writes the in-memory index out as the new table and empties the journal, all of which is
+//! now in the table. The caller holds both the store lock and the journal lock.
+//!
+//! @param[in] bs
+//! @param[in] journal_fd the open and exclusively locked journal
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int index_write_table(blobstore * bs, int journal_fd)
+{
+    int ret = 0;
+    char path[PATH_MAX] = "";
+    char tmp_path[PATH_MAX] = "";
+    FILE *fp = NULL;
+    struct stat sb;
+    blobstore_index *idx = bs->index;
+    blobstore_index_entry *e = NULL;
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s", bs->path, BLOBSTORE_INDEX_TMP_FILE);
+    if ((fp = fopen(tmp_path, "w")) == NULL) {
+        LOGWARN("failed to write blob index %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    fchmod(fileno(fp), BLOBSTORE_FILE_PERM);
+
+    fprintf(fp, BLOBSTORE_INDEX_HEADER);
+    for (int i = 0; i < idx->entries_size; i++) {
+        e = &(idx->entries[i]);
+        if (e->id == NULL)
+            continue;
+        fprintf(fp, "+ %s %llu %llu %lld %lld %d %u %d %s %s\n", e->id, e->size_bytes, e->blocks_allocated, (long long)e->last_accessed,
+                (long long)e->last_modified, e->is_hollow, e->in_use, (int)e->opener, ((e->device_path && strlen(e->device_path)) ? e->device_path : "-"),
+                ((e->dm_name && strlen(e->dm_name)) ? e->dm_name : "-"));
+    }
+    if (fflush(fp) || fsync(fileno(fp)))
+        ret = -1;
+    if (fclose(fp))
+        ret = -1;
+
+    if (ret || rename(tmp_path, path) || stat(path, &sb)) {
+        LOGWARN("failed to write blob index %s\n", path);
+        unlink(tmp_path);
+        return -1;
+    }
+    // records left in the journal (if we die before truncating it) are repeated in the table, which is harmless
+    if (ftruncate(journal_fd, 0) == -1) {
+        LOGWARN("failed to truncate blob index journal of %s: %s\n", bs->path, strerror(errno));
+    }
+
+    idx->table_ino = sb.st_ino;
+    idx->table_size = sb.st_size;
+    idx->table_mtime = sb.st_mtime;
+    idx->journal_offset = 0;
+    idx->journal_records = 0;
+    idx->loaded = 1;
+    return 0;
+}
+
+//!
+//! Rebuilds the blob index from the files on disk. This is the recovery path, taken when the
+//! table does not exist (a store created before the index existed, or an invalidated index) or
+//! cannot be read. The journal stays locked for the duration, so no change is lost.
+//!
+//! @param[in] bs the store, which the caller has locked
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int index_rebuild(blobstore * bs)
+{
+    int fd = -1;
+    int ret = -1;
+    int num_blobs = 0;
+    char path[PATH_MAX] = "";
+    char record[BLOBSTORE_INDEX_RECORD_SIZE] = "";
+    blockblob *bbs = NULL;
+
+    LOGINFO("rebuilding the blob index of %s\n", bs->path);
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    if ((fd = open(path, O_RDWR | O_CREAT, BLOBSTORE_FILE_PERM)) == -1) {
+        LOGWARN("failed to open blob index journal %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (flock(fd, LOCK_EX) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    index_clear(bs->index);
+    if (walk_bs(bs, bs->path, &bbs, NULL) != NULL) {
+        ret = 0;
+        for (blockblob * abb = bbs; abb && !ret; abb = abb->next) {
+            if (index_format(bs, abb->id, record, sizeof(record)) < 0 || index_apply(bs->index, record)) {
+                ret = -1;
+            }
+            num_blobs++;
+        }
+    }
+    free_bbs(bbs);
+
+    if (!ret && (ret = index_write_table(bs, fd)) == 0) {
+        LOGINFO("indexed %d blob(s) in %s\n", num_blobs, bs->path);
+    } else {
+        index_clear(bs->index);
+    }
+    close(fd);
+    return ret;
+}
+
+//!
+//! Folds the journal into the table, so that loading the index does not have to replay an
+//! ever growing journal
+//!
+//! @param[in] bs the store, which the caller has locked
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int index_compact(blobstore * bs)
+{
+    int fd = -1;
+    int ret = -1;
+    int records = 0;
+    char path[PATH_MAX] = "";
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    if ((fd = open(path, O_RDWR)) == -1)
+        return -1;
+    if (flock(fd, LOCK_EX) == 0) {
+        // pick up whatever got appended since we last looked
+        if ((records = index_replay(bs->index, fd, &(bs->index->journal_offset), NULL)) >= 0) {
+            LOGDEBUG("folding %d journal record(s) into the blob index of %s\n", bs->index->journal_records + records, bs->path);
+            ret = index_write_table(bs, fd);
+        }
+    }
+    close(fd);
+    return ret;
+}
+
+//!
+//! Brings the in-memory index of the store up to date with the on-disk one: reloads the table
+//! if some process rewrote it (or we never loaded it), then applies whatever was appended to the
+//! journal since we last looked. The index is rebuilt from the files on disk if the table is
+//! missing or corrupt.
+//!
+//! @param[in] bs the store, which the caller has locked
+//!
+//! @return 0 if the in-memory index is current or -1 if it could not be brought up to date
+//!
+static int index_sync(blobstore * bs)
+{
+    int fd = -1;
+    int records = 0;
+    off_t offset = 0;
+    char path[PATH_MAX] = "";
+    struct stat sb;
+    blobstore_index *idx = NULL;
+
+    if (bs->index == NULL) {
+        if ((bs->index = EUCA_ZALLOC(1, sizeof(blobstore_index))) == NULL)
+            return -1;
+    }
+    idx = bs->index;
+    if (idx->sparse != (bs->sparse_accounting ? 1 : 0)) {
+        idx->sparse = (bs->sparse_accounting ? 1 : 0);
+        idx->loaded = 0;               // the totals are kept one way or the other, so count them again
+    }
+
+    for (int attempt = 0; attempt < 3; attempt++) {
+        snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+        if (stat(path, &sb) == -1) {
+            if (errno != ENOENT || index_rebuild(bs))
+                return -1;
+            continue;
+        }
+
+        if (!idx->loaded || sb.st_ino != idx->table_ino || sb.st_size != idx->table_size || sb.st_mtime != idx->table_mtime) {
+            index_clear(idx);
+            offset = 0;
+            if ((fd = open(path, O_RDONLY)) == -1)
+                return -1;
+            records = index_replay(idx, fd, &offset, BLOBSTORE_INDEX_HEADER);
+            close(fd);
+            if (records < 0) {
+                LOGWARN("blob index %s is corrupt\n", path);
+                if (index_rebuild(bs))
+                    return -1;
+                continue;
+            }
+            idx->table_ino = sb.st_ino;
+            idx->table_size = sb.st_size;
+            idx->table_mtime = sb.st_mtime;
+            idx->loaded = 1;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+        if ((fd = open(path, O_RDONLY)) == -1) {
+            if (errno == ENOENT)
+                return 0;              // nothing journaled since the table was written
+            return -1;
+        }
+        records = -1;
+        if (flock(fd, LOCK_SH) == 0) {
+            records = index_replay(idx, fd, &(idx->journal_offset), NULL);
+        }
+        close(fd);
+        if (records < 0) {
+            idx->loaded = 0;           // (most likely) compacted by someone else, so reload it all
+            continue;
+        }
+        idx->journal_records += records;
+
+        if (idx->journal_records > BLOBSTORE_INDEX_COMPACT_RECORDS && idx->journal_records > (BLOBSTORE_INDEX_COMPACT_RATIO * idx->live)) {
+            index_compact(bs);         // the index is current either way
+        }
+        return 0;
+    }
+    return -1;
+}
+
+//!
+//! Frees the in-memory index of a store
+//!
+//! @param[in] bs
+//!
+static void index_free(blobstore * bs)
+{
+    if (bs->index) {
+        index_clear(bs->index);
+        EUCA_FREE(bs->index->entries);
+        EUCA_FREE(bs->index->slots);
+        EUCA_FREE(bs->index->heap);
+        EUCA_FREE(bs->index);
+    }
+}
+
+//!
+//! Tells whether the process recorded as having a blob open is still around
+//!
+//! @param[in] e
+//!
+//! @return 1 if the blob is open, 0 otherwise
+//!
+static int index_is_opened(const blobstore_index_entry * e)
+{
+    return (e->opener > 0 && (kill(e->opener, 0) == 0 || errno == EPERM));
+}
+
+//!
+//! Reports how many blocks the blobs of the store take, split into those that are open and
+//! thus cannot be purged and those that potentially can. Without 'exact' this comes straight
+//! from the running totals, which count a blob as open if it was recorded so. With it, the
+//! entries are gone through to leave out the blobs whose opener has died (or that the caller
+//! is creating), just like a scan of the store would.
+//!
+//! @param[in]  bs the store, which the caller has locked and synced the index of
+//! @param[in]  bb_to_avoid blob to leave out of the totals, if any
+//! @param[in]  exact set to 1 to check on the openers
+//! @param[out] blocks_locked
+//! @param[out] blocks_unlocked
+//!
+static void index_usage(blobstore * bs, const blockblob * bb_to_avoid, int exact, long long *blocks_locked, long long *blocks_unlocked)
+{
+    blobstore_index *idx = bs->index;
+    blobstore_index_entry *e = NULL;
+    long long size_blocks = 0;
+
+    if (!exact) {
+        *blocks_locked = idx->blocks_opened;
+        *blocks_unlocked = idx->blocks_used - idx->blocks_opened;
+        if (bb_to_avoid && (e = index_find(idx, bb_to_avoid->id, 0)) != NULL && !e->is_hollow) {
+            size_blocks = index_limit_blocks(idx, e, (e->opener > 0));
+            if (e->opener > 0) {
+                *blocks_locked -= size_blocks;
+            } else {
+                *blocks_unlocked -= size_blocks;
+            }
+        }
+        return;
+    }
+
+    *blocks_locked = 0;
+    *blocks_unlocked = 0;
+    for (int i = 0; i < idx->entries_size; i++) {
+        e = &(idx->entries[i]);
+        if (e->id == NULL || e->is_hollow)
+            continue;
+        if (bb_to_avoid && !strcmp(e->id, bb_to_avoid->id))
+            continue;
+        if (index_is_opened(e)) {
+            *blocks_locked += index_limit_blocks(idx, e, TRUE);
+        } else {
+            *blocks_unlocked += index_limit_blocks(idx, e, FALSE);
+        }
+    }
+}
+
+//!
+//! Takes a blob that nobody has open, by locking it the way blockblob_open() would, without
+//! waiting, and recording the claim in the index so that others count the blob as open
+//!
+//! @param[in]  bs the store, which the caller has locked
+//! @param[in]  bb_id
+//! @param[out] claim filled out if the blob is claimed
+//!
+//! @return 0 if the blob was claimed or -1 if it is open (or otherwise could not be locked)
+//!
+static int claim_blob(blobstore * bs, const char *bb_id, blockblob_claim * claim)
+{
+    int len = 0;
+    char path[PATH_MAX] = "";
+    char thread_id[512] = "";
+
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb_id, path, sizeof(path));
+    if ((claim->fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, 0, BLOBSTORE_FILE_PERM)) == -1)
+        return -1;
+
+    snprintf(thread_id, sizeof(thread_id), "%d/%u", getpid(), (unsigned int)pthread_self());
+    len = strlen(thread_id);
+    if (ftruncate(claim->fd, 0) != 0 || write(claim->fd, thread_id, len) != len) {
+        close_and_unlock(claim->fd);
+        claim->fd = -1;
+        return -1;
+    }
+    euca_strncpy(claim->id, bb_id, sizeof(claim->id));
+    index_record(bs, bb_id);           // others now count it as open
+    return 0;
+}
+
+//!
+//! Lets go of a blob taken by claim_blob(), or of what is left of it, recording in the index
+//! that it is either gone or no longer open. The store lock need not be held.
+//!
+//! @param[in] bs
+//! @param[in] claim
+//!
+static void release_claim(blobstore * bs, blockblob_claim * claim)
+{
+    if (ftruncate(claim->fd, 0) != 0) {
+        LOGWARN("failed to truncate the lock file of blob %s\n", claim->id);
+    }
+    close_and_unlock(claim->fd);
+    claim->fd = -1;
+    index_record(bs, claim->id);
+}
+
+//!
+//! Purges least recently modified blobs until 'need_blocks' are freed, taking them in order
+//! from the LRU heap of the index rather than sorting the whole store. The heap is not
+//! modified while it is being walked: candidates are taken from a second, small heap that
+//! starts at the root and grows by the children of every position taken, so that looking at
+//! k blobs costs O(k log k). Blobs that others depend on are retried once their children
+//! have been purged, same as purge_blockblobs_lru() does.
+//!
+//! With 'claims', the blobs are only claimed rather than deleted, so that the caller can
+//! delete them after releasing the store lock (see purge_index_lru_unlocked()). Blobs that
+//! others depend on are then skipped, since their children are not gone yet.
+//!
+//! @param[in]  bs the store, which the caller has locked and synced the index of
+//! @param[in]  need_blocks
+//! @param[out] claims array with room for as many blobs as the index has, or NULL to delete right away
+//! @param[out] claims_size number of blobs claimed, if 'claims' is not NULL
+//!
+//! @return the number of blocks purged (or claimed)
+//!
+static long long purge_index_lru(blobstore * bs, long long need_blocks, blockblob_claim * claims, int *claims_size)
+{
+#define AUX_KEY(_pos)  (idx->entries[idx->heap[aux[(_pos)]]].last_modified)
+    int i = 0;
+    int j = 0;
+    int pos = 0;
+    int aux_size = 0;
+    int retry_size = 0;
+    int deleted_size = 0;
+    int iteration = 0;
+    int deleted = 0;
+    long long purged = 0;
+    int *aux = NULL;
+    int *retry = NULL;
+    int *deleted_entries = NULL;
+    blockblob *bb = NULL;
+    blobstore_index *idx = bs->index;
+    blobstore_index_entry *e = NULL;
+
+    if (claims)
+        *claims_size = 0;
+    if (idx->heap_size == 0)
+        return purged;
+
+    aux = EUCA_ALLOC(idx->heap_size, sizeof(int));
+    retry = EUCA_ALLOC(idx->heap_size, sizeof(int));
+    deleted_entries = EUCA_ALLOC(idx->heap_size, sizeof(int));
+    bb = EUCA_ZALLOC(1, sizeof(blockblob));
+    if (!aux || !retry || !deleted_entries || !bb)
+        goto free;
+    bb->store = bs;
+
+    aux[aux_size++] = 0;
+    for (iteration = 0; purged < need_blocks; iteration++) {
+        int round_size = retry_size;
+        int kept = 0;
+
+        if (iteration > 0 && (!deleted || !retry_size))
+            break;                     // nothing got deleted on the last round, so no more children went away
+        deleted = 0;
+
+        for (j = 0; purged < need_blocks; j++) {
+            if (iteration == 0) {
+                // take the least recently modified blob that has not been looked at yet
+                if (aux_size == 0)
+                    break;
+                pos = aux[0];
+                aux[0] = aux[--aux_size];
+                for (i = 0; (2 * i + 1) < aux_size;) {
+                    int min = (((2 * i + 2) < aux_size) && (AUX_KEY(2 * i + 2) < AUX_KEY(2 * i + 1))) ? (2 * i + 2) : (2 * i + 1);
+                    if (AUX_KEY(i) <= AUX_KEY(min))
+                        break;
+                    int t = aux[i];
+                    aux[i] = aux[min];
+                    aux[min] = t;
+                    i = min;
+                }
+                for (int child = 2 * pos + 1; child <= 2 * pos + 2 && child < idx->heap_size; child++) {
+                    for (i = aux_size++, aux[i] = child; i > 0 && AUX_KEY(i) < AUX_KEY((i - 1) / 2); i = (i - 1) / 2) {
+                        int t = aux[i];
+                        aux[i] = aux[(i - 1) / 2];
+                        aux[(i - 1) / 2] = t;
+                    }
+                }
+                e = &(idx->entries[idx->heap[pos]]);
+            } else {
+                // go over the ones that had children on the previous round, in the same order
+                if (j == round_size)
+                    break;
+                e = &(idx->entries[retry[j]]);
+            }
+
+            euca_strncpy(bb->id, e->id, sizeof(bb->id));
+            bb->size_bytes = e->size_bytes;
+            bb->last_modified = e->last_modified;
+            if (claims) {
+                // claiming the blob is what tells whether it is open, so there is no need to check first
+                bb->in_use = check_relations(bs, bb->id);
+                if (!(bb->in_use & BLOCKBLOB_STATUS_MAPPED) && claim_blob(bs, bb->id, &(claims[*claims_size])) == -1)
+                    bb->in_use |= BLOCKBLOB_STATUS_OPENED;
+            } else {
+                bb->in_use = check_in_use(bs, bb->id, 0);   // record in-use status
+            }
+
+            char code = '?';
+            if ((bb->in_use & BLOCKBLOB_STATUS_MAPPED) && claims) {
+                code = 'C';                // its children may be purged by the caller, after which it will come up again
+
+            } else if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+                // mapped blobs have children, thus cannot be deleted at this iteration
+                retry[(iteration == 0) ? retry_size++ : kept++] = e - idx->entries;
+                code = 'C';
+
+            } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
+                code = 'O';
+
+            } else if (claims) {
+                claims[*claims_size].size_bytes = bb->size_bytes;
+                claims[*claims_size].limit_blocks = index_limit_blocks(idx, e, FALSE);
+                purged += claims[(*claims_size)++].limit_blocks;
+                code = 'L';
+
+            } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1, TRUE) == -1) {
+                code = '!';
+
+            } else {
+                purged += index_limit_blocks(idx, e, FALSE);
+                deleted_entries[deleted_size++] = e - idx->entries;
+                code = 'D';
+                deleted++;
+            }
+            LOGDEBUG("LRU %d %08lld: %29s %c%c%c%c %c %9llu %s", iteration, purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'),    // o = open
+                     (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
+                     (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
+                     (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
+                     code,             // outcome codes: D=deleted, L=claimed for deletion, else C=children, !=undeletable, O=open
+                     bb->size_bytes / 512L, // size is in sectors
+                     ctime(&(bb->last_modified)));  // ctime adds a newline
+        }
+
+        if (iteration > 0)
+            retry_size = kept;         // the ones that still have children
+    }
+
+    // the deletions are journaled, too, but we may as well reflect them right away
+    for (i = 0; i < deleted_size; i++) {
+        e = &(idx->entries[deleted_entries[i]]);
+        if (e->id)
+            index_remove(idx, e);
+    }
+
+free:
+    EUCA_FREE(aux);
+    EUCA_FREE(retry);
+    EUCA_FREE(deleted_entries);
+    EUCA_FREE(bb);
+    return purged;
+#undef AUX_KEY
+}
+
+//!
+//! Purges least recently modified blobs until the store uses no more than 'target_blocks',
+//! without holding the store lock while blobs are torn down. Each round claims enough blobs
+//! under the lock, then releases it to remove their devices and files, which may take long,
+//! and takes it again to see where the store stands. Since the claimed blobs appear open to
+//! everyone else, no one else tries to purge them in the meantime.
+//!
+//! @param[in] bs the store, which the caller has locked and synced the index of
+//! @param[in] target_blocks
+//! @param[in] timeout_usec how long to wait for the store lock each time it is taken again
+//!
+//! @return the number of blocks purged or -1 if the store lock could not be taken again, in
+//!         which case the store is left unlocked
+//!
+static long long purge_index_lru_unlocked(blobstore * bs, long long target_blocks, long long timeout_usec)
+{
+    int claims_size = 0;
+    long long purged = 0;
+    long long round_purged = 0;
+    long long blocks_locked = 0;
+    long long blocks_unlocked = 0;
+    blockblob *bb = NULL;
+    blockblob_claim *claims = NULL;
+
+    if ((bb = EUCA_ZALLOC(1, sizeof(blockblob))) == NULL)
+        return purged;
+    bb->store = bs;
+
+    do {
+        index_usage(bs, NULL, 0, &blocks_locked, &blocks_unlocked);
+        if ((blocks_locked + blocks_unlocked) <= target_blocks || bs->index->heap_size == 0)
+            break;
+        if ((claims = EUCA_ZALLOC(bs->index->heap_size, sizeof(blockblob_claim))) == NULL)
+            break;
+        purge_index_lru(bs, (blocks_locked + blocks_unlocked) - target_blocks, claims, &claims_size);
+        if (claims_size == 0) {
+            EUCA_FREE(claims);
+            break;
+        }
+
+        blobstore_unlock(bs);
+        round_purged = 0;
+        for (int i = 0; i < claims_size; i++) {
+            euca_strncpy(bb->id, claims[i].id, sizeof(bb->id));
+            bb->size_bytes = claims[i].size_bytes;
+            if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1, FALSE) == 0) {
+                round_purged += claims[i].limit_blocks;
             }
+            release_claim(bs, &(claims[i]));
         }
+        EUCA_FREE(claims);
+        purged += round_purged;
 
-        if (array) {
-            for (int i = 0; i < array_size; i++)
-                EUCA_FREE(array[i]);
-            EUCA_FREE(array);
+        if (blobstore_lock(bs, timeout_usec) == -1) {
+            EUCA_FREE(bb);
+            return -1;
         }
-    }
+        if (index_sync(bs))
+            break;
+    } while (round_purged > 0);        // a round that purged nothing would only claim the same blobs again
 
-free:
-    closedir(dir);
-    return tail_bb;
+    EUCA_FREE(bb);
+    return purged;
 }
 
 //!
-//! Runs through the blobstore and puts all found blockblobs into a linked list, returning its head
+//! Puts all blockblobs of the blobstore into a linked list, returning its head. The list
+//! comes from the blob index, which avoids walking the directory tree and reading the
+//! metadata files of every blob. The tree is only walked if the index cannot be used.
 //!
 //! @param[in] bs
 //! @param[in] bb_to_avoid
 //!
 //! @return A pointer to the head of a linked list containing all found blockblobs
 //!
-//! @pre
+//! @pre The blobstore must be locked.
 //!
 //! @note
 //!
 static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
 {
     blockblob *bbs = NULL;
-    if (walk_bs(bs, bs->path, &bbs, bb_to_avoid) == NULL) {
-        if (bbs)
+    blockblob **tail_bb = &bbs;
+    blobstore_error_t saved_errno = _blobstore_errno;
+
+    if (index_sync(bs)) {
+        // no usable index, so fall back to walking the whole store
+        LOGWARN("blob index of %s is not available, scanning the store\n", bs->path);
+        _blobstore_errno = saved_errno;
+        if (walk_bs(bs, bs->path, &bbs, bb_to_avoid) == NULL) {
+            if (bbs)
+                free_bbs(bbs);
+            bbs = NULL;
+        }
+        return bbs;
+    }
+    _blobstore_errno = saved_errno;    // rebuilding the index may have set it
+
+    for (int i = 0; i < bs->index->entries_size; i++) {
+        blobstore_index_entry *e = &(bs->index->entries[i]);
+        if (e->id == NULL)
+            continue;                  // removed
+        if (bb_to_avoid != NULL && strcmp(e->id, bb_to_avoid->id) == 0)
+            continue;                  // avoid that particular blockblob
+
+        blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+        if (bb == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
             free_bbs(bbs);
-        bbs = NULL;
+            return NULL;
+        }
+        *tail_bb = bb;                 // add to LL
+        tail_bb = &(bb->next);
+
+        // fill out the struct from the index, the way walk_bs() would from the files
+        bb->store = bs;
+        euca_strncpy(bb->id, e->id, sizeof(bb->id));
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+        if (e->device_path)
+            euca_strncpy(bb->device_path, e->device_path, sizeof(bb->device_path));
+        if (e->dm_name)
+            euca_strncpy(bb->dm_name, e->dm_name, sizeof(bb->dm_name));
+        bb->size_bytes = e->size_bytes;
+        bb->blocks_allocated = e->blocks_allocated;
+        bb->last_accessed = e->last_accessed;
+        bb->last_modified = e->last_modified;
+        bb->snapshot_type = BLOBSTORE_FORMAT_ANY;   // it is not necessary to know whether this is a snapshot
+        bb->is_hollow = e->is_hollow;
+        bb->in_use = e->in_use;
+        if (index_is_opened(e)) {
+            bb->in_use |= BLOCKBLOB_STATUS_OPENED;
+        } else if (e->opener != 0) {
+            bb->in_use |= BLOCKBLOB_STATUS_ABANDONED;   // lock file was not truncated => blob not properly closed
+        }
     }
 
     return bbs;
@@ -2631,7 +4572,7 @@ static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long
                     bb_array[i] = NULL; // mark it to skip in the future
                     code = 'O';
 
-                } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
+                } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1, TRUE) == -1) {
                     bb_array[i] = NULL; // mark it to skip in the future
                     code = '!';
 
@@ -2659,6 +4600,178 @@ static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long
     return purged;
 }
 
+//!
+//! Purges least recently used blobs, once the store has grown past 'high_blocks', until it
+//! is down to 'low_blocks'. Meant to be called in the background, so that creating a blob
+//! rarely has to wait for the purging. Only stores with the LRU revocation policy are purged.
+//!
+//! @param[in] bs
+//! @param[in] high_blocks how full, in blocks, the store may get before anything is purged
+//! @param[in] low_blocks how full, in blocks, the store should be after purging
+//!
+//! @return the number of blocks purged or -1 on error
+//!
+long long blobstore_evict(blobstore * bs, unsigned long long high_blocks, unsigned long long low_blocks)
+{
+    long long purged = 0;
+    long long blocks_locked = 0;
+    long long blocks_unlocked = 0;
+
+    if (bs->revocation_policy != BLOBSTORE_REVOCATION_LRU) {
+        return 0;
+    }
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
+        return -1;
+    }
+
+    if (index_sync(bs)) {
+        purged = -1;                   // without the index this would be a walk of the whole store, so do not bother
+    } else {
+        index_usage(bs, NULL, 1, &blocks_locked, &blocks_unlocked);
+        if ((blocks_locked + blocks_unlocked) > high_blocks) {
+            LOGDEBUG("%s is using %lld of %llu blocks, purging down to %llu\n", bs->path, (blocks_locked + blocks_unlocked), bs->limit_blocks, low_blocks);
+            _err_off();                // do not care about errors during purging
+            EUCA_PROBE1(blob__purge__start, ((blocks_locked + blocks_unlocked) - (long long)low_blocks));
+            purged = purge_index_lru_unlocked(bs, low_blocks, BLOBSTORE_LOCK_TIMEOUT_USEC);
+            EUCA_PROBE1(blob__purge__done, purged);
+            _err_on();
+            if (purged == -1) {
+                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore after purging");
+                return -1;             // it was left unlocked
+            }
+        }
+    }
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+        purged = -1;
+    }
+    return purged;
+}
+
+//!
+//! Sets whether blobs that are neither open nor related to other blobs count toward the limit
+//! of the store by the blocks they take on disk, rather than by their size, which leaves more
+//! room in a store whose blobs are sparse or have had zeroes punched out of them by
+//! blobstore_reclaim(). Opening such a blob again counts it in full without checking the
+//! limit, so this only suits stores whose blobs are not written to once they are complete,
+//! such as caches of images. All processes using the store should set this the same way.
+//!
+//! @param[in] bs
+//! @param[in] enabled set to TRUE to count blobs by the blocks they take on disk
+//!
+void blobstore_set_sparse_accounting(blobstore * bs, int enabled)
+{
+    bs->sparse_accounting = (enabled ? TRUE : FALSE);   // the index counts its totals again when next synced
+}
+
+//!
+//! Gives back to the file system the blocks of blobs that hold nothing but zeroes. Only the
+//! blobs that are neither open, nor hollow, nor related to other blobs are looked at, since
+//! nothing else can be writing to their files, and each is claimed while it is gone through
+//! (see claim_blob()), so that no one opens or purges it in the meantime. Blobs that have not
+//! been modified since the last call are skipped, as punching holes leaves the times alone.
+//! This must not be used on stores whose closed blobs may be written to through their files.
+//!
+//! @param[in] bs
+//!
+//! @return the number of blocks given back or -1 on error
+//!
+long long blobstore_reclaim(blobstore * bs)
+{
+    int ret = 0;
+    int ids_size = 0;
+    long long reclaimed = 0;
+    long long reclaimed_bytes = 0;
+    time_t started = time(NULL);
+    time_t next_mtime = started;
+    time_t *mtimes = NULL;
+    char **ids = NULL;
+    char path[PATH_MAX] = "";
+    blockblob_claim claim = { 0 };
+    blobstore_index *idx = NULL;
+    blobstore_index_entry *e = NULL;
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
+        return -1;
+    }
+
+    if (index_sync(bs)) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to read the blob index");
+        ret = -1;
+    } else if (((ids = EUCA_ZALLOC(bs->index->live + 1, sizeof(char *))) == NULL) || ((mtimes = EUCA_ZALLOC(bs->index->live + 1, sizeof(time_t))) == NULL)) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+    } else {
+        idx = bs->index;
+        for (int i = 0; (i < idx->entries_size) && (ids_size < idx->live); i++) {
+            e = &(idx->entries[i]);
+            if ((e->id == NULL) || e->is_hollow || (e->blocks_allocated == 0) || (e->last_modified < bs->reclaim_mtime))
+                continue;
+            if ((e->opener != 0) || (e->in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED))) {
+                if (e->last_modified < next_mtime)
+                    next_mtime = e->last_modified;  // look at it again once it is idle
+                continue;
+            }
+            if ((ids[ids_size] = strdup(e->id)) != NULL)
+                mtimes[ids_size++] = e->last_modified;
+        }
+    }
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+        ret = -1;
+    }
+
+    for (int i = 0; (i < ids_size) && (ret == 0); i++) {
+        if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
+            ret = -1;
+            break;
+        }
+        _err_off();                    // the blob may have been opened or deleted since
+        if (claim_blob(bs, ids[i], &claim) == -1) {
+            claim.fd = -1;
+        } else if (check_relations(bs, ids[i]) & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED)) {
+            release_claim(bs, &claim);
+        }
+        _err_on();
+        blobstore_unlock(bs);
+
+        if (claim.fd == -1) {
+            if (mtimes[i] < next_mtime)
+                next_mtime = mtimes[i];
+            continue;
+        }
+
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, ids[i], path, sizeof(path));
+        switch (diskutil_punch_zeros(path, &reclaimed_bytes)) {
+        case EUCA_OK:
+            reclaimed += reclaimed_bytes / 512;
+            break;
+        case EUCA_UNSUPPORTED_ERROR:
+            ERR(BLOBSTORE_ERROR_INVAL, "the file system of the blobstore cannot punch holes");
+            ret = -1;
+            break;
+        default:
+            LOGWARN("failed to punch zeroes out of blob %s\n", ids[i]);
+            break;
+        }
+        release_claim(bs, &claim);     // records the blocks the blob takes now
+    }
+
+    if (ret == 0)
+        bs->reclaim_mtime = next_mtime;
+    for (int i = 0; i < ids_size; i++)
+        EUCA_FREE(ids[i]);
+    EUCA_FREE(ids);
+    EUCA_FREE(mtimes);
+    return ((ret == 0) ? reclaimed : -1);
+}
+
 //!
 //!
 //!
@@ -2693,7 +4806,8 @@ int blobstore_stat(blobstore * bs, blobstore_meta * meta)
     meta->num_blobs = 0;
     for (blockblob * abb = bbs; abb;) {
         //! @TODO unify this with locked/unlocked calculation in open()
-        long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
+        long long abb_size_blocks = blob_limit_blocks(bs->sparse_accounting, abb->size_bytes, abb->blocks_allocated, abb->in_use,
+                                                      (abb->in_use & BLOCKBLOB_STATUS_OPENED));
         if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
             // these can't be purged if we need space
             //! @TODO look into recursive purging of unused references?
@@ -2722,6 +4836,22 @@ unlock:
     meta->snapshot_policy = bs->snapshot_policy;
     meta->format = bs->format;
     meta->blocks_limit = bs->limit_blocks;
+    meta->pool_blocks_size = 0;
+    meta->pool_blocks_used = 0;
+    pthread_mutex_lock(&_blobstore_stats_mutex);
+    meta->store_lock_stats = bs->store_lock_stats;
+    meta->blob_lock_stats = bs->blob_lock_stats;
+    pthread_mutex_unlock(&_blobstore_stats_mutex);
+    if (bs->snapshot_policy == BLOBSTORE_SNAPSHOT_THIN) {
+        char pool_name[MAX_DM_NAME] = "";
+        thin_pool_status status = { 0 };
+
+        thin_pool_name(bs, pool_name, sizeof(pool_name));
+        if (dm_check_device(pool_name) == 0 && thin_pool_get_status(pool_name, &status) == 0) {  // a pool that is not up yet is not set up here
+            meta->pool_blocks_size = status.data_blocks_total * BLOBSTORE_POOL_BLOCK_SECTORS;
+            meta->pool_blocks_used = status.data_blocks_used * BLOBSTORE_POOL_BLOCK_SECTORS;
+        }
+    }
     if (realpath(bs->path, meta->path) == NULL) {
         LOGERROR("failed to resolve the blobstore path %s\n", bs->path);
         ret = EUCA_ERROR;
@@ -2817,22 +4947,330 @@ stale_ref:
     return stale_refs;
 }
 
+//!
+//! Checksums the contents of a metadata file (FNV-1a)
+//!
+//! @param[in] buf
+//! @param[in] len
+//!
+//! @return the checksum
+//!
+static unsigned int fsck_checksum(const char *buf, int len)
+{
+    unsigned int h = 2166136261U;
+
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)buf[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+//!
+//! Describes the state of the packed metadata of a blob, which changes whenever devices of the
+//! blob are set up or torn down, by its modification time, size and checksum
+//!
+//! @param[in]  bs
+//! @param[in]  bb_id
+//! @param[out] state
+//! @param[in]  state_size
+//!
+//! @return 0 on success or -1 if the blob has no packed metadata (as blobs created by older
+//!         versions may not), in which case it always has to be checked in full
+//!
+static int fsck_blob_state(const blobstore * bs, const char *bb_id, char *state, int state_size)
+{
+    int fd = -1;
+    int ret = -1;
+    char path[PATH_MAX] = "";
+    char *buf = NULL;
+    struct stat sb;
+
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_META, bs, bb_id, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+    if (fstat(fd, &sb) == 0 && sb.st_size <= BLOBSTORE_MAX_PACKED_METADATA && (buf = EUCA_ALLOC(sb.st_size + 1, 1)) != NULL) {
+        if (read(fd, buf, sb.st_size) == sb.st_size) {
+            snprintf(state, state_size, "%lld %lld %08x", (long long)sb.st_mtime, (long long)sb.st_size, fsck_checksum(buf, sb.st_size));
+            ret = 0;
+        }
+        EUCA_FREE(buf);
+    }
+    close(fd);
+    return ret;
+}
+
+//!
+//! Reads the ID of the current boot of the host. Since loop and dm devices do not survive a
+//! reboot, what the last fsck found holds only within the boot it ran in.
+//!
+//! @param[out] boot_id the ID or an empty string if it is not known
+//! @param[in]  boot_id_size
+//!
+static void fsck_get_boot_id(char *boot_id, int boot_id_size)
+{
+    FILE *fp = NULL;
+
+    boot_id[0] = '\0';
+    if ((fp = fopen(BLOBSTORE_BOOT_ID_PATH, "r")) != NULL) {
+        if (fgets(boot_id, boot_id_size, fp) == NULL)
+            boot_id[0] = '\0';
+        fclose(fp);
+    }
+    boot_id[strcspn(boot_id, " \t\n")] = '\0';
+}
+
+//!
+//! Comparator of fsck record lines for qsort() and bsearch()
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return as with strcmp()
+//!
+static int fsck_compare_lines(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+//!
+//! Loads what the last fsck of the store found, provided it ran during the current boot
+//!
+//! @param[in]  bs
+//! @param[in]  boot_id
+//! @param[out] record left empty if there is nothing usable
+//!
+static void fsck_load_record(const blobstore * bs, const char *boot_id, fsck_record * record)
+{
+    int capacity = 0;
+    char path[PATH_MAX] = "";
+    char line[BLOBSTORE_MAX_PATH + 128] = "";
+    char **lines = NULL;
+    FILE *fp = NULL;
+
+    bzero(record, sizeof(fsck_record));
+    if (strlen(boot_id) == 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_FSCK_FILE);
+    if ((fp = fopen(path, "r")) == NULL)
+        return;
+
+    if (fgets(line, sizeof(line), fp) == NULL || strcmp(line, BLOBSTORE_FSCK_HEADER)
+        || fgets(line, sizeof(line), fp) == NULL || strncmp(line, "boot ", 5) || strncmp(line + 5, boot_id, strlen(boot_id)) || line[5 + strlen(boot_id)] != '\n') {
+        fclose(fp);
+        return;                        // another version or another boot
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (record->size == capacity) {
+            capacity = (capacity == 0) ? 256 : (capacity * 2);
+            if ((lines = EUCA_REALLOC(record->lines, capacity, sizeof(char *))) == NULL)
+                break;
+            record->lines = lines;
+        }
+        if ((record->lines[record->size] = strdup(line)) == NULL)
+            break;
+        record->size++;
+    }
+    fclose(fp);
+
+    if (record->size > 0)
+        qsort(record->lines, record->size, sizeof(char *), fsck_compare_lines);
+}
+
+//!
+//! Tells whether a blob was found consistent by the last fsck with its metadata as it is now
+//!
+//! @param[in] record
+//! @param[in] line '<id> <metadata state>' of the blob
+//!
+//! @return TRUE if it was or FALSE otherwise
+//!
+static int fsck_is_recorded(const fsck_record * record, const char *line)
+{
+    if (record->size == 0)
+        return FALSE;
+    return (bsearch(&line, record->lines, record->size, sizeof(char *), fsck_compare_lines) != NULL);
+}
+
+//!
+//! Frees the lines of an fsck record
+//!
+//! @param[in] record
+//!
+static void fsck_free_record(fsck_record * record)
+{
+    for (int i = 0; i < record->size; i++) {
+        EUCA_FREE(record->lines[i]);
+    }
+    EUCA_FREE(record->lines);
+    record->size = 0;
+}
+
+//!
+//! Writes down the blobs that the fsck found consistent, so that the next fsck during the same
+//! boot can skip checking the devices of those whose metadata has not changed since. Blobs whose
+//! metadata changed while they were being checked are left out, as what was checked is gone.
+//!
+//! @param[in] bs
+//! @param[in] boot_id
+//! @param[in] work blobs examined, with the state of their metadata when they were
+//! @param[in] condemned per blob, TRUE if it was found inconsistent or condemned by the examiner
+//!
+static void fsck_save_record(blobstore * bs, const char *boot_id, const fsck_work * work, const char *condemned)
+{
+    char path[PATH_MAX] = "";
+    char tmp_path[PATH_MAX] = "";
+    char state[128] = "";
+    FILE *fp = NULL;
+
+    if (strlen(boot_id) == 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_FSCK_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s", bs->path, BLOBSTORE_FSCK_TMP_FILE);
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1)  // so that two of these do not write the file at once
+        return;
+
+    if ((fp = fopen(tmp_path, "w")) != NULL) {
+        fchmod(fileno(fp), BLOBSTORE_FILE_PERM);
+        fprintf(fp, BLOBSTORE_FSCK_HEADER "boot %s\n", boot_id);
+        for (int i = 0; i < work->size; i++) {
+            if (condemned[i] || work->states[i] == NULL || strpbrk(work->bbs[i]->id, " \t\n"))
+                continue;
+            if (fsck_blob_state(bs, work->bbs[i]->id, state, sizeof(state)) == 0 && !strcmp(state, work->states[i]))
+                fprintf(fp, "%s %s\n", work->bbs[i]->id, state);
+        }
+        if (fclose(fp) != 0 || rename(tmp_path, path) == -1) {
+            LOGWARN("failed to write %s, the next check of %s will be a full one\n", path, bs->path);
+            unlink(tmp_path);
+        }
+    }
+
+    if (blobstore_unlock(bs) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+    }
+}
+
+//!
+//! Creates the pool of workers that check the devices of blobs, once per process
+//!
+static void fsck_pool_init(void)
+{
+    if ((fsck_pool = thread_pool_create("fsck", BLOBSTORE_FSCK_WORKERS)) == NULL)
+        LOGWARN("failed to start the fsck workers, checking blobs with one thread\n");
+}
+
+//!
+//! Task of an fsck that checks the devices of blobs, taking them one at a time
+//!
+//! @param[in] arg the fsck_work shared by the tasks
+//!
+//! @return NULL
+//!
+static void *fsck_worker(void *arg)
+{
+    int i = 0;
+    fsck_work *work = (fsck_work *) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&(work->mutex));
+        while (work->next < work->size && work->errors[work->next] == -1)
+            work->next++;              // no need to check this one
+        i = work->next++;
+        pthread_mutex_unlock(&(work->mutex));
+        if (i >= work->size)
+            break;
+        work->errors[i] = blockblob_check(work->bbs[i], TRUE);
+    }
+    return NULL;
+}
+
+//!
+//! Checks the devices of all blobs that need it, with up to BLOBSTORE_FSCK_WORKERS tasks of
+//! fsck_pool besides the calling thread
+//!
+//! @param[in] work blobs to check, of which those with errors[] set to -1 are skipped; on
+//!            return, errors[] holds the number of problems found with each of the others
+//!
+static void fsck_check_devices(fsck_work * work)
+{
+    int i = 0;
+    int to_check = 0;
+    int num_tasks = 0;
+    thread_pool_future *tasks[BLOBSTORE_FSCK_WORKERS] = { NULL };
+
+    for (i = 0; i < work->size; i++) {
+        if (work->errors[i] != -1)
+            to_check++;
+    }
+
+    work->next = 0;
+    pthread_mutex_init(&(work->mutex), NULL);
+    pthread_once(&fsck_pool_once, fsck_pool_init);
+    for (i = 0; i < BLOBSTORE_FSCK_WORKERS && i < (to_check - 1); i++) {    // the calling thread is a worker, too
+        if ((tasks[num_tasks] = thread_pool_submit(fsck_pool, fsck_worker, work)) == NULL)
+            break;
+        num_tasks++;
+    }
+    fsck_worker(work);
+    for (i = 0; i < num_tasks; i++) {
+        thread_pool_wait(tasks[i]);    // runs the tasks no worker got to, which find nothing left to check
+    }
+    pthread_mutex_destroy(&(work->mutex));
+}
+
 //!
 //! Checks the integrity check of the blobstore. With a non-NULL examiner(), each found
 //! blob is passed to it for examination and the blob is deleted if function returns non-zero
 //!
+//! The dm and loop devices of the blobs, the slowest to check, are checked by a pool of
+//! threads, and not at all for blobs that the last fsck during the same boot found to be
+//! consistent and whose metadata has not changed since. The examiner is always called from
+//! the calling thread, one blob at a time.
+//!
 //! @param[in] bs
 //! @param[in] examiner
 //!
-//! @return
+//! @return 0 on success or -1 on error
 //!
-//! @pre
+//! @see blobstore_fsck_pass()
+//!
+int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
+{
+    return blobstore_fsck_pass(bs, examiner, TRUE, NULL);
+}
+
+//!
+//! Checks the integrity of the blobstore, as blobstore_fsck() does, or only the metadata
+//! of its blobs and their relations, leaving their dm and loop devices for a later pass.
+//! A metadata-only pass does not update the record of consistent blobs, so the next full
+//! check still examines the devices of all of them.
+//!
+//! @param[in]  bs
+//! @param[in]  examiner
+//! @param[in]  check_devices set to TRUE to check the devices of the blobs, too
+//! @param[out] stats if not NULL, what was examined and done, and how long it took
 //!
-//! @note
+//! @return 0 on success or -1 on error
 //!
-int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
+int blobstore_fsck_pass(blobstore * bs, int (*examiner) (const blockblob * bb), int check_devices, blobstore_fsck_stats * stats)
 {
     int ret = 0;
+    int i = 0;
+    int num_skipped = 0;
+    char boot_id[64] = "";
+    char line[BLOBSTORE_MAX_PATH + 128] = "";
+    char state[128] = "";
+    char *condemned = NULL;
+    fsck_record record = { 0 };
+    fsck_work work = { 0 };
+    long long started = mono_time_usec();
+
+    if (stats)
+        bzero(stats, sizeof(blobstore_fsck_stats));
 
     if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
@@ -2855,6 +5293,37 @@ int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
         goto free;
     }
 
+    for (blockblob * abb = bbs; abb; abb = abb->next) {
+        work.size++;
+    }
+    work.bbs = EUCA_ZALLOC(work.size, sizeof(blockblob *));
+    work.errors = EUCA_ZALLOC(work.size, sizeof(int));
+    work.states = EUCA_ZALLOC(work.size, sizeof(char *));
+    condemned = EUCA_ZALLOC(work.size, sizeof(char));
+    if (!work.bbs || !work.errors || !work.states || !condemned) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+        goto free;
+    }
+
+    fsck_get_boot_id(boot_id, sizeof(boot_id));
+    fsck_load_record(bs, boot_id, &record);
+    i = 0;
+    for (blockblob * abb = bbs; abb; abb = abb->next, i++) {
+        work.bbs[i] = abb;
+        if (fsck_blob_state(bs, abb->id, state, sizeof(state)) == 0) {
+            work.states[i] = strdup(state);
+            snprintf(line, sizeof(line), "%s %s", abb->id, state);
+            if (fsck_is_recorded(&record, line)) {
+                work.errors[i] = -1;   // its devices checked out and nothing about them changed since
+                num_skipped++;
+            }
+        }
+    }
+    fsck_free_record(&record);
+    if (check_devices)
+        fsck_check_devices(&work);
+
     {                                  // check objects in the blobstore
 
         unsigned int num_blobs = 0;
@@ -2866,8 +5335,9 @@ int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
         for (; iterations < 10; iterations++) { // outer loop for multiple iterations over the list
             unsigned int to_delete = 0;
 
-            // run through LL, examining each blockblob
-            for (blockblob * abb = bbs; abb; abb = abb->next) {
+            // run through the blobs, examining each blockblob
+            for (i = 0; i < work.size; i++) {
+                blockblob *abb = work.bbs[i];
                 if (iterations == 1)
                     num_blobs++;       // count all blobs on the first iteration
 
@@ -2875,8 +5345,9 @@ int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
                     continue;
 
                 // examiner(), if specified, tell us whether to delete the blob
-                if (blockblob_check(abb) || // blob state is inconsistent
+                if ((work.errors[i] > 0) || blockblob_check(abb, FALSE) ||  // blob state is inconsistent
                     (examiner && examiner(abb))) {  // blobstore user condemned the blob
+                    condemned[i] = TRUE;
 
                     blockblob *bb = blockblob_open(bs, abb->id, 0, 0, NULL, BLOBSTORE_FIND_TIMEOUT_USEC);
                     if (bb != NULL) {
@@ -2928,13 +5399,33 @@ int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
         }
 
         if (num_blobs > 0)
-            LOGINFO("%s: examined %d blob(s) in %d iteration(s): "
-                    "deleted %d, failed on %d + %d, failed to open %d\n", bs->path, num_blobs, iterations, blobs_deleted, to_delete_prev, blobs_undeletable, blobs_unopenable);
+            LOGINFO("%s: examined %d blob(s) in %d iteration(s), %d of them unchanged since the last check: "
+                    "deleted %d, failed on %d + %d, failed to open %d\n", bs->path, num_blobs, iterations, num_skipped, blobs_deleted, to_delete_prev, blobs_undeletable,
+                    blobs_unopenable);
+        if (stats) {
+            stats->num_blobs = num_blobs;
+            stats->num_skipped = num_skipped;
+            stats->num_deleted = blobs_deleted;
+            stats->num_failed = to_delete_prev + blobs_undeletable;
+            stats->num_unopenable = blobs_unopenable;
+        }
     }
+    if (check_devices)
+        fsck_save_record(bs, boot_id, &work, condemned);
+
 free:
+    for (i = 0; work.states && i < work.size; i++) {
+        EUCA_FREE(work.states[i]);
+    }
+    EUCA_FREE(work.states);
+    EUCA_FREE(work.bbs);
+    EUCA_FREE(work.errors);
+    EUCA_FREE(condemned);
     if (bbs) {
         free_bbs(bbs);
     }
+    if (stats)
+        stats->usec = mono_time_usec() - started;
 
     return ret;
 }
@@ -3035,6 +5526,144 @@ free:
     return ret;
 }
 
+//!
+//! Looks up a cached blob by a key derived from its content, as recorded with
+//! blobstore_put_content_key(), so that artifacts with different IDs but the same
+//! content can share one blob
+//!
+//! @param[in]  bs
+//! @param[in]  key content key, without whitespace
+//! @param[out] bb_id ID of the blob with that content
+//! @param[in]  bb_id_size
+//!
+//! @return 0 if a blob that still exists was found or -1 otherwise
+//!
+int blobstore_get_content_key(blobstore * bs, const char *key, char *bb_id, int bb_id_size)
+{
+    int fd = -1;
+    int size = 0;
+    int ret = -1;
+    char *buf = NULL;
+    char *line = NULL;
+    char *saveptr = NULL;
+    char path[PATH_MAX] = "";
+    char blocks_path[PATH_MAX] = "";
+    char k[BLOBSTORE_MAX_PATH] = "";
+    char id[BLOBSTORE_MAX_PATH] = "";
+    struct stat sb = { 0 };
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_CONTENT_INDEX_FILE);
+    if (stat(path, &sb) == -1)
+        return -1;                     // nothing has been recorded yet
+    if ((fd = open_and_lock(path, BLOBSTORE_FLAG_RDONLY, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1)
+        return -1;
+
+    if ((buf = EUCA_ZALLOC(sb.st_size + 1, sizeof(char))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        goto unlock;
+    }
+    if ((size = fd_to_buf(fd, buf, sb.st_size)) == -1)
+        goto unlock;
+    buf[size] = '\0';
+
+    for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        if ((sscanf(line, "%s %s", k, id) == 2) && !strcmp(k, key)) {
+            // blobs get purged from under the index, so only report the ones that are still there
+            if ((set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, id, blocks_path, sizeof(blocks_path)) == 0) && (stat(blocks_path, &sb) == 0)) {
+                euca_strncpy(bb_id, id, bb_id_size);
+                ret = 0;
+            }
+            break;
+        }
+    }
+
+unlock:
+    EUCA_FREE(buf);
+    close_and_unlock(fd);
+    return ret;
+}
+
+//!
+//! Records the content key of a blob, replacing any earlier blob with the same key,
+//! and drops entries for blobs that no longer exist
+//!
+//! @param[in] bs
+//! @param[in] key content key, without whitespace
+//! @param[in] bb_id ID of the blob with that content
+//!
+//! @return 0 on success or -1 on error
+//!
+int blobstore_put_content_key(blobstore * bs, const char *key, const char *bb_id)
+{
+    int fd = -1;
+    int size = 0;
+    int ret = 0;
+    char *buf = NULL;
+    char *out = NULL;
+    char *line = NULL;
+    char *saveptr = NULL;
+    char entry[BLOBSTORE_MAX_PATH * 2 + 2] = "";
+    char path[PATH_MAX] = "";
+    char blocks_path[PATH_MAX] = "";
+    char k[BLOBSTORE_MAX_PATH] = "";
+    char id[BLOBSTORE_MAX_PATH] = "";
+    struct stat sb = { 0 };
+
+    if (strpbrk(key, " \t\n") || strpbrk(bb_id, " \t\n") || (strlen(key) >= sizeof(k)) || (strlen(bb_id) >= sizeof(id))) {
+        ERR(BLOBSTORE_ERROR_INVAL, "invalid content key or blob ID");
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_CONTENT_INDEX_FILE);
+    if (stat(path, &sb) == -1)
+        fd = open_and_lock(path, BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM);
+    if ((fd == -1) && ((fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1))
+        return -1;
+
+    if ((fstat(fd, &sb) == -1) || ((buf = EUCA_ZALLOC(sb.st_size + 1, sizeof(char))) == NULL)) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+        goto unlock;
+    }
+    if ((size = fd_to_buf(fd, buf, sb.st_size)) == -1) {
+        ret = -1;
+        goto unlock;
+    }
+    buf[size] = '\0';
+
+    snprintf(entry, sizeof(entry), "%s %s\n", key, bb_id);
+    for (line = strstr(buf, entry); line && (line != buf) && (line[-1] != '\n'); line = strstr(line + 1, entry)) ;
+    if (line)
+        goto unlock;                   // already recorded, which is the common case of a launch from cache
+
+    out = strdup(entry);
+    for (line = strtok_r(buf, "\n", &saveptr); line && out; line = strtok_r(NULL, "\n", &saveptr)) {
+        if ((sscanf(line, "%s %s", k, id) != 2) || !strcmp(k, key) || !strcmp(id, bb_id))
+            continue;
+        if ((set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, id, blocks_path, sizeof(blocks_path)) == -1) || (stat(blocks_path, &sb) == -1))
+            continue;
+        snprintf(entry, sizeof(entry), "%s %s\n", k, id);
+        out = euca_strdupcat(out, entry);
+    }
+    if (out == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+        goto unlock;
+    }
+
+    if ((ftruncate(fd, 0) == -1) || (buf_to_fd(fd, out, strlen(out)) != strlen(out))) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to write the content index");
+        ret = -1;
+    }
+
+unlock:
+    EUCA_FREE(buf);
+    EUCA_FREE(out);
+    if (close_and_unlock(fd) != 0)
+        ret = -1;
+    return ret;
+}
+
 //!
 //!
 //!
@@ -3121,6 +5750,7 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
     }
 
     LOGTRACE("{%u} blockblob_open: opening blob id=%s flags=%d timeout=%lld\n", (unsigned int)pthread_self(), id, flags, timeout_usec);
+    EUCA_PROBE2(blob__open__start, id, flags);
 
     blockblob *bbs = NULL;             // a temp LL of blockblobs, used for computing free space and for purging
     blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
@@ -3140,29 +5770,35 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
     bb->size_bytes = size_bytes;
     set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
 
+    // the store lock is only needed where the directories of blobs or the space of the store
+    // are concerned, so opening an existing blob only takes the lock of that blob
     int blobstore_locked = 0;
-    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can create blob's file atomically
-        goto free;                     // failed to obtain a lock on the blobstore
-    } else {
-        blobstore_locked = 1;
-    }
+    int created_directory = 0;
+    if (flags & BLOBSTORE_FLAG_CREAT) {
+        if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can create blob's file atomically
+            goto free;                 // failed to obtain a lock on the blobstore
+        } else {
+            blobstore_locked = 1;
+        }
 
-    //! @TODO maybe don't create directories needlessly if flags==0?
-    int created_directory = ensure_blockblob_metadata_path(bs, bb->id);
-    if (created_directory == -1) {
-        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-        goto unlock;
-    }
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-        goto free;
+        created_directory = ensure_blockblob_metadata_path(bs, bb->id);
+        if (created_directory == -1) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto unlock;
+        }
+        if (blobstore_unlock(bs) == -1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+            goto free;
+        }
+        blobstore_locked = 0;
     }
-    blobstore_locked = 0;
 
     int created_blob = 0;
     char lpath[PATH_MAX];
     set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb->id, lpath, sizeof(lpath));
+    long long lock_started = mono_time_usec();
     bb->fd_lock = open_and_lock(lpath, flags | BLOBSTORE_FLAG_RDWR, timeout_usec, BLOBSTORE_FILE_PERM); // blobs are always opened with exclusive write access
+    account_lock_wait(&(bs->blob_lock_stats), lock_started, (bb->fd_lock != -1));
     if (bb->fd_lock == -1) {
         // failed to open/create and lock the blockblob
         goto clean;
@@ -3203,44 +5839,76 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
     if (sb.st_size == 0) {             // new blob
         created_blob = 1;
 
-        if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse blobstore safely
-            goto clean;                // failed to obtain a lock on the blobstore
-        } else {
-            blobstore_locked = 1;
+        // the blob file is ours alone, so sizing it and writing its metadata need not hold up the store
+        if (lseek(bb->fd_blocks, size_bytes - 1, SEEK_CUR) == (off_t) - 1) {    // create a file with a hole
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto clean;
         }
-
-        // put existing items in the blobstore into a LL
-        _blobstore_errno = BLOBSTORE_ERROR_OK;
-        bbs = scan_blobstore(bs, bb);
-        if (bbs == NULL) {
-            if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+        if (write(bb->fd_blocks, zero_buf, 1) != (ssize_t) 1) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto clean;
+        }
+        if (sig)
+            if (write_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb->id, sig)) {
                 goto clean;
             }
-        }
+        bb->snapshot_type = BLOBSTORE_SNAPSHOT_NONE;    // just created, so not a snapshot
+
         // a bit of a hack: HOLLOW blobs skip the blobstore limit check upon creation
         if (flags & BLOBSTORE_FLAG_HOLLOW) {
             bb->is_hollow = TRUE;
             if (write_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb->id, "this blob is hollow\n"))
                 goto clean;
+        }
+
+        if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can account for the space safely
+            goto clean;                // failed to obtain a lock on the blobstore
+        } else {
+            blobstore_locked = 1;
+        }
 
-        } else {                       // enforce blobstore limits
+        // the blob index keeps running totals and an LRU ordering, so there is no need for a list of all blobs
+        int use_index = 0;
+        _blobstore_errno = BLOBSTORE_ERROR_OK;
+        if (index_record(bs, bb->id) == 0 && index_sync(bs) == 0) { // with the blob in the index, its space is taken as soon as the lock is released
+            use_index = 1;
+            _blobstore_errno = BLOBSTORE_ERROR_OK;  // rebuilding the index may have set it
+        } else {
+            // put existing items in the blobstore into a LL
+            _blobstore_errno = BLOBSTORE_ERROR_OK;
+            bbs = scan_blobstore(bs, bb);
+            if (bbs == NULL) {
+                if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+                    goto clean;
+                }
+            }
+        }
+        if (!(flags & BLOBSTORE_FLAG_HOLLOW)) { // enforce blobstore limits
 
-            // analyze the LL, calculating sizes
             long long blocks_unlocked = 0;
             long long blocks_locked = 0;
             unsigned int num_blobs = 0;
-            for (blockblob * abb = bbs; abb; abb = abb->next) {
-                long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
-                if (abb->is_hollow)
-                    abb_size_blocks = 0;
-                if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
-                    // these can't be purged if we need space
-                    //! @TODO look into recursive purging of unused references?
-                    blocks_locked += abb_size_blocks;
-                } else {
-                    blocks_unlocked += abb_size_blocks; // these potentially can be purged, unless they are depended on by locked ones
+            if (use_index) {
+                index_usage(bs, bb, 0, &blocks_locked, &blocks_unlocked);
+                if (((long long)bs->limit_blocks - blocks_locked) < size_blocks) {
+                    // the totals may count blobs whose opener has died as open, so look closer before giving up
+                    index_usage(bs, bb, 1, &blocks_locked, &blocks_unlocked);
+                }
+            } else {
+                // analyze the LL, calculating sizes
+                for (blockblob * abb = bbs; abb; abb = abb->next) {
+                    long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
+                    if (abb->is_hollow)
+                        abb_size_blocks = 0;
+                    if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
+                        // these can't be purged if we need space
+                        //! @TODO look into recursive purging of unused references?
+                        blocks_locked += abb_size_blocks;
+                    } else {
+                        blocks_unlocked += abb_size_blocks; // these potentially can be purged, unless they are depended on by locked ones
+                    }
+                    num_blobs++;
                 }
-                num_blobs++;
             }
 
             long long blocks_free = bs->limit_blocks - (blocks_unlocked + blocks_locked);
@@ -3251,9 +5919,28 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
                     goto clean;
                 }
                 long long blocks_needed = size_blocks - blocks_free;
+                long long blocks_freed = 0;
                 _err_off();            // do not care about errors duing purging
-                long long blocks_freed = purge_blockblobs_lru(bs, bbs, blocks_needed);
+                EUCA_PROBE1(blob__purge__start, blocks_needed);
+                if (use_index) {
+                    // the blob is in the index already, so purging down to the limit makes room for it,
+                    // even if others took some of the space while the lock was released for purging
+                    blocks_freed = purge_index_lru_unlocked(bs, bs->limit_blocks, timeout_usec);
+                    if (blocks_freed != -1) {
+                        index_usage(bs, NULL, 1, &blocks_locked, &blocks_unlocked);
+                        if ((blocks_locked + blocks_unlocked) <= (long long)bs->limit_blocks)
+                            blocks_freed = blocks_needed;   // whatever was purged, there is room now
+                    }
+                } else {
+                    blocks_freed = purge_blockblobs_lru(bs, bbs, blocks_needed);
+                }
+                EUCA_PROBE1(blob__purge__done, blocks_freed);
                 _err_on();
+                if (blocks_freed == -1) {
+                    blobstore_locked = 0;  // the purge could not take the lock back
+                    ERR(BLOBSTORE_ERROR_AGAIN, "failed to lock the blobstore after purging");
+                    goto clean;
+                }
                 if (blocks_freed < blocks_needed) {
                     ERR(BLOBSTORE_ERROR_NOSPC, "could not purge enough from cache");
                     goto clean;
@@ -3261,20 +5948,6 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
             }
         }
 
-        if (lseek(bb->fd_blocks, size_bytes - 1, SEEK_CUR) == (off_t) - 1) {    // create a file with a hole
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto clean;
-        }
-        if (write(bb->fd_blocks, zero_buf, 1) != (ssize_t) 1) {
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto clean;
-        }
-        if (sig)
-            if (write_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb->id, sig)) {
-                goto clean;
-            }
-        bb->snapshot_type = BLOBSTORE_SNAPSHOT_NONE;    // just created, so not a snapshot
-
         if (blobstore_unlock(bs) == -1) {
             ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
         }
@@ -3338,6 +6011,7 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
     }
 
     set_device_path(bb);               // read .dm and .loopback and set bb->device_path accordingly
+    index_record(bs, bb->id);          // records the blob (again) as opened by us
 
     goto out;                          // all is well
 
@@ -3377,6 +6051,7 @@ free:
 
 out:
     LOGTRACE("{%u} blockblob_open: done with blob id=%s ret=%p\n", (unsigned int)pthread_self(), id, bb);
+    EUCA_PROBE2(blob__open__done, id, bb);
     if (bb == NULL) {
         LOGTRACE("{%u} blockblob_open: errno=%d msg=%s\n", (unsigned int)pthread_self(), _blobstore_errno, blobstore_get_last_msg());
     }
@@ -3402,58 +6077,236 @@ static int loop_remove(blobstore * bs, const char *bb_id)
     char path[PATH_MAX] = "";
     int ret = 0;
 
-    _err_off();                        // do not care if loopback file does not exist
-    read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));   // loads path of /dev/loop?
-    _err_on();
+    _err_off();                        // do not care if loopback file does not exist
+    read_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));   // loads path of /dev/loop?
+    _err_on();
+
+    if (strlen(path)) {
+        if (diskutil_unloop(path)) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove loopback device for blockblob");
+            ret = -1;
+        } else {
+            write_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, "");  // clear the loopback field
+        }
+    }
+
+    return ret;
+}
+
+//!
+//! releases the blob locks, allowing others to open() it, and frees the blockblob handle
+//!
+//! @param[in] bb
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blockblob_close(blockblob * bb)
+{
+    if (bb == NULL) {
+        ERR(BLOBSTORE_ERROR_INVAL, NULL);
+        return -1;
+    }
+    int ret = 0;
+    LOGTRACE("{%u} blockblob_close: closing blob id=%s\n", (unsigned int)pthread_self(), bb->id);
+
+    // do not remove /dev/loop* if it is used by device mapper
+    // (we do not care about BLOCKBLOB_STATUS_OPENED because
+    // it should be only this thread that has the blob open)
+    int in_use = check_in_use(bb->store, bb->id, 0);
+    if (!(in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED))) {
+        ret = loop_remove(bb->store, bb->id);
+    }
+    ret |= close(bb->fd_blocks);
+    if (ftruncate(bb->fd_lock, 0) != 0) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+    }
+    index_record(bb->store, bb->id);   // while still holding the blob lock, so nobody can open it before this is recorded
+    ret |= close_and_unlock(bb->fd_lock);
+    EUCA_FREE(bb);                     // we free the blob regardless of whether closing succeeds or not
+    return ret;
+}
+
+#ifdef HAVE_LIBDEVMAPPER
+//!
+//! Tells whether device mapper devices can be managed in-process, through libdevmapper, which
+//! takes the privileges that otherwise only the rootwrap'ed 'dmsetup' has
+//!
+//! @return TRUE if libdevmapper can be used or FALSE if 'dmsetup' is needed
+//!
+static int dm_lib_usable(void)
+{
+    static int usable = -1;
+    char version[64] = "";
+
+    if (usable == -1) {
+        usable = ((geteuid() == 0) && dm_driver_version(version, sizeof(version))) ? TRUE : FALSE;
+        if (usable) {
+            dm_udev_set_sync_support(1);
+        }
+        LOGDEBUG("managing device mapper devices %s\n", (usable ? "through libdevmapper" : "with 'dmsetup'"));
+    }
+    return usable;
+}
+
+//!
+//! Runs a libdevmapper task on a device, optionally tying it to a udev cookie
+//!
+//! @param[in]  type DM_DEVICE_REMOVE, DM_DEVICE_SUSPEND, DM_DEVICE_RESUME or DM_DEVICE_INFO
+//! @param[in]  dev_name
+//! @param[in]  cookie udev cookie shared by a batch of tasks, or NULL for none
+//! @param[out] info state of the device after the task, if not NULL
+//!
+//! @return 0 on success or -1 on error
+//!
+static int dm_lib_run(int type, const char *dev_name, uint32_t * cookie, struct dm_info *info)
+{
+    int ret = -1;
+    struct dm_task *dmt = NULL;
+
+    if ((dmt = dm_task_create(type)) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
+    }
+    if (dm_task_set_name(dmt, dev_name)
+        && ((type != DM_DEVICE_REMOVE) || dm_task_retry_remove(dmt))
+        && ((cookie == NULL) || dm_task_set_cookie(dmt, cookie, 0))
+        && dm_task_run(dmt)
+        && ((info == NULL) || dm_task_get_info(dmt, info))) {
+        ret = 0;
+    }
+    dm_task_destroy(dmt);
+    return ret;
+}
+
+//!
+//! Creates all devices, in order, with a single udev synchronization at the end instead of one
+//! per device. Since the nodes of the devices may not be in /dev/mapper before that, references
+//! to devices created earlier in the batch are passed to the kernel as major:minor.
+//!
+//! @param[in]  dev_names
+//! @param[in]  dm_tables
+//! @param[in]  size
+//! @param[out] created number of devices that were created, which the caller must remove on failure
+//!
+//! @return 0 on success or -1 on error
+//!
+static int dm_lib_create_devices(char *dev_names[], char *dm_tables[], int size, int *created)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int ret = 0;
+    int used = 0;
+    uint32_t cookie = 0;
+    unsigned long long start = 0;
+    unsigned long long length = 0;
+    char type[32] = "";
+    char params[MAX_DM_LINE] = "";
+    char *line = NULL;
+    char *next = NULL;
+    char *tok = NULL;
+    char *saveptr = NULL;
+    char *table = NULL;
+    char (*devnos)[32] = NULL;
+    struct dm_task *dmt = NULL;
+    struct dm_info info = { 0 };
+
+    *created = 0;
+    if ((devnos = EUCA_ZALLOC(size, sizeof(*devnos))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return -1;
+    }
+
+    for (i = 0; (i < size) && (ret == 0); i++) {
+        myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
+
+        if (((dmt = dm_task_create(DM_DEVICE_CREATE)) == NULL) || ((table = strdup(dm_tables[i])) == NULL)) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            ret = -1;
+            break;
+        }
+
+        for (line = table; line && *line && (ret == 0); line = next) {
+            if ((next = strchr(line, '\n')) != NULL)
+                *(next++) = '\0';
+            if (sscanf(line, "%llu %llu %31s %n", &start, &length, type, &used) < 3) {
+                ERR(BLOBSTORE_ERROR_INVAL, "malformed device mapper table");
+                ret = -1;
+                break;
+            }
+
+            for (params[0] = '\0', tok = strtok_r(line + used, " ", &saveptr); tok; tok = strtok_r(NULL, " ", &saveptr)) {
+                k = -1;
+                if (!strncmp(tok, DM_PATH, strlen(DM_PATH))) {
+                    for (j = 0; j < i; j++) {
+                        if (!strcmp(tok + strlen(DM_PATH), dev_names[j]))
+                            k = j;
+                    }
+                }
+                euca_strncat(params, ((params[0] == '\0') ? "" : " "), sizeof(params));
+                euca_strncat(params, ((k >= 0) ? devnos[k] : tok), sizeof(params));
+            }
 
-    if (strlen(path)) {
-        if (diskutil_unloop(path)) {
-            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove loopback device for blockblob");
+            if (!dm_task_add_target(dmt, start, length, type, params)) {
+                ERR(BLOBSTORE_ERROR_INVAL, "failed to add a target to the device mapper table");
+                ret = -1;
+            }
+        }
+        EUCA_FREE(table);
+
+        if ((ret == 0) && dm_task_set_name(dmt, dev_names[i]) && dm_task_set_cookie(dmt, &cookie, 0) && dm_task_run(dmt) && dm_task_get_info(dmt, &info)) {
+            snprintf(devnos[i], sizeof(devnos[i]), "%u:%u", info.major, info.minor);
+            (*created)++;
+        } else if (ret == 0) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to set up device mapper table with libdevmapper");
+            myprintf(EUCA_LOG_INFO, "{%u} input: %s", (unsigned int)pthread_self(), dm_tables[i]);
             ret = -1;
-        } else {
-            set_blockblob_metadata_path(BLOCKBLOB_PATH_LOOPBACK, bs, bb_id, path, sizeof(path));    // load path of .../loopback file itself
-            unlink(path);
         }
+        dm_task_destroy(dmt);
+        dmt = NULL;
     }
 
+    if (dmt)
+        dm_task_destroy(dmt);
+    if (cookie && !dm_udev_wait(cookie)) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to wait for udev to create device mapper nodes");
+        ret = -1;
+    }
+    EUCA_FREE(devnos);
     return ret;
 }
 
 //!
-//! releases the blob locks, allowing others to open() it, and frees the blockblob handle
-//!
-//! @param[in] bb
-//!
-//! @return
+//! Removes devices, in order, with a single udev synchronization at the end
 //!
-//! @pre
+//! @param[in] dev_names
+//! @param[in] size
 //!
-//! @note
+//! @return 0 if the last device was removed or -1 otherwise, as with dm_delete_device()
 //!
-int blockblob_close(blockblob * bb)
+static int dm_lib_delete_devices(char *dev_names[], int size)
 {
-    if (bb == NULL) {
-        ERR(BLOBSTORE_ERROR_INVAL, NULL);
-        return -1;
-    }
     int ret = 0;
-    LOGTRACE("{%u} blockblob_close: closing blob id=%s\n", (unsigned int)pthread_self(), bb->id);
+    uint32_t cookie = 0;
 
-    // do not remove /dev/loop* if it is used by device mapper
-    // (we do not care about BLOCKBLOB_STATUS_OPENED because
-    // it should be only this thread that has the blob open)
-    int in_use = check_in_use(bb->store, bb->id, 0);
-    if (!(in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED))) {
-        ret = loop_remove(bb->store, bb->id);
+    for (int i = 0; i < size; i++) {
+        myprintf(EUCA_LOG_INFO, "removing device %s\n", dev_names[i]);
+        if ((ret = dm_lib_run(DM_DEVICE_REMOVE, dev_names[i], &cookie, NULL)) != 0) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device with libdevmapper");
+        }
     }
-    ret |= close(bb->fd_blocks);
-    if (ftruncate(bb->fd_lock, 0) != 0) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
+
+    if (cookie && !dm_udev_wait(cookie)) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to wait for udev to remove device mapper nodes");
+        ret = -1;
     }
-    ret |= close_and_unlock(bb->fd_lock);
-    EUCA_FREE(bb);                     // we free the blob regardless of whether closing succeeds or not
     return ret;
 }
+#endif /* HAVE_LIBDEVMAPPER */
 
 //!
 //!
@@ -3470,6 +6323,24 @@ static int dm_suspend_resume(const char *dev_name)
 {
     int ret = EUCA_OK;
 
+#ifdef HAVE_LIBDEVMAPPER
+    if (dm_lib_usable()) {
+        uint32_t cookie = 0;
+        if (dm_lib_run(DM_DEVICE_SUSPEND, dev_name, NULL, NULL) != 0) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend device with libdevmapper");
+            return (-1);
+        }
+        ret = dm_lib_run(DM_DEVICE_RESUME, dev_name, &cookie, NULL);
+        if (cookie)
+            dm_udev_wait(cookie);
+        if (ret != 0) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to resume device with libdevmapper");
+            return (-1);
+        }
+        return (0);
+    }
+#endif /* HAVE_LIBDEVMAPPER */
+
     if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "suspend", dev_name, NULL)) != EUCA_OK) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend device with 'dmsetup'");
         return (-1);
@@ -3577,6 +6448,51 @@ static int dm_delete_devices(char *dev_names[], int size)
         }
     }
 
+#ifdef HAVE_LIBDEVMAPPER
+    if (dm_lib_usable()) {
+        // collect the partition devices (see below) and the devices themselves, so that all of them go in one batch
+        int batched = 0;
+        char **dev_names_batch = EUCA_ZALLOC(devices * 19, sizeof(char *));
+        if (dev_names_batch == NULL) {
+            EUCA_FREE(dev_names_removable);
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            return -1;
+        }
+        for (int i = 0; i < devices; i++) {
+            for (int j = 1; j < 10; j++) {
+                char name_p[1024];
+                char path_p[1024];
+                snprintf(name_p, sizeof(name_p), "%sp%d", dev_names_removable[i], j);
+                snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
+                if (check_path(path_p) == 0)
+                    dev_names_batch[batched++] = strdup(name_p);
+                snprintf(name_p, sizeof(name_p), "%s%d", dev_names_removable[i], j);
+                snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
+                if (check_path(path_p) == 0)
+                    dev_names_batch[batched++] = strdup(name_p);
+            }
+            char dm_path[MAX_DM_PATH];
+            snprintf(dm_path, sizeof(dm_path), DM_FORMAT, dev_names_removable[i]);
+            errno = 0;
+            if (!check_path(dm_path) || (errno != ENOENT))
+                dev_names_batch[batched++] = strdup(dev_names_removable[i]);
+        }
+        for (int i = 0; i < batched; i++) {
+            if (dev_names_batch[i] == NULL) {
+                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+                ret = -1;
+            }
+        }
+        if (ret == 0)
+            ret = dm_lib_delete_devices(dev_names_batch, batched);
+        for (int i = 0; i < batched; i++)
+            EUCA_FREE(dev_names_batch[i]);
+        EUCA_FREE(dev_names_batch);
+        EUCA_FREE(dev_names_removable);
+        return ret;
+    }
+#endif /* HAVE_LIBDEVMAPPER */
+
     // run through devices and remove them
     for (int i = 0; i < devices; i++) {
 
@@ -3630,6 +6546,25 @@ static int dm_create_devices(char *dev_names[], char *dm_tables[], int size)
     char tmpfile[EUCA_MAX_PATH] = "";
     char dm_path[MAX_DM_PATH] = "";
 
+#ifdef HAVE_LIBDEVMAPPER
+    if (dm_lib_usable()) {
+        int created = 0;
+        if (dm_lib_create_devices(dev_names, dm_tables, size, &created) != 0) {
+            i = created - 1;           // so that only the devices that were created get removed below
+            goto cleanup;
+        }
+        for (i = 0; i < size; i++) {
+            snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_names[i]);
+            if (diskutil_ch(dm_path, get_username(), NULL, BLOBSTORE_FILE_PERM) != EUCA_OK) {
+                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to change permissions on the device mapper file\n");
+                i = size - 1;
+                goto cleanup;
+            }
+        }
+        return (0);
+    }
+#endif /* HAVE_LIBDEVMAPPER */
+
     for (i = 0; i < size; i++) {
         // create devices one by one
         myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
@@ -3732,23 +6667,368 @@ static char *dm_get_zero(void)
 }
 
 //!
+//! Sends a message to the target of a device mapper device, such as a thin pool
 //!
+//! @param[in] dev_name
+//! @param[in] verb the message, e.g., "create_thin" or "delete"
+//! @param[in] arg its argument
 //!
-//! @param[in] bb
+//! @return 0 on success or -1 on error
 //!
-//! @return
+static int dm_message_device(const char *dev_name, const char *verb, const char *arg)
+{
+#ifdef HAVE_LIBDEVMAPPER
+    if (dm_lib_usable()) {
+        int ret = -1;
+        char msg[MAX_DM_LINE] = "";
+        struct dm_task *dmt = NULL;
+
+        snprintf(msg, sizeof(msg), "%s %s", verb, arg);
+        if ((dmt = dm_task_create(DM_DEVICE_TARGET_MSG)) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            return -1;
+        }
+        if (dm_task_set_name(dmt, dev_name) && dm_task_set_sector(dmt, 0) && dm_task_set_message(dmt, msg) && dm_task_run(dmt))
+            ret = 0;
+        dm_task_destroy(dmt);
+        if (ret)
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to send a message to device with libdevmapper");
+        return ret;
+    }
+#endif /* HAVE_LIBDEVMAPPER */
+
+    if (euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "message", dev_name, "0", verb, arg, NULL) != EUCA_OK) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to send a message to device with 'dmsetup'");
+        return -1;
+    }
+    return 0;
+}
+
 //!
-//! @pre
+//! Picks the data usage out of the status line of a thin pool, which reads
+//! '<start> <length> thin-pool <transaction id> <used>/<total metadata blocks> <used>/<total data blocks> ...'
 //!
-//! @note
+//! @param[in] line a line of 'dmsetup status' output
+//! @param[in] data the thin_pool_status to fill in
+//!
+//! @return 0 so that all lines get looked at
+//!
+static int thin_pool_parse_status(const char *line, void *data)
+{
+    unsigned long long used = 0;
+    unsigned long long total = 0;
+    const char *params = NULL;
+    thin_pool_status *status = ((thin_pool_status *) data);
+
+    if (((params = strstr(line, " thin-pool ")) != NULL)
+        && (sscanf(params, " thin-pool %*s %*u/%*u %llu/%llu", &used, &total) == 2)) {
+        status->data_blocks_used = used;
+        status->data_blocks_total = total;
+        status->found = TRUE;
+    }
+    return 0;
+}
+
+//!
+//! Gets the data usage of a thin pool
+//!
+//! @param[in]  pool_name
+//! @param[out] status
+//!
+//! @return 0 on success or -1 if the pool does not exist or its status could not be parsed
+//!
+static int thin_pool_get_status(const char *pool_name, thin_pool_status * status)
+{
+    bzero(status, sizeof(thin_pool_status));
+
+#ifdef HAVE_LIBDEVMAPPER
+    if (dm_lib_usable()) {
+        uint64_t start = 0;
+        uint64_t length = 0;
+        char line[MAX_DM_LINE] = "";
+        char *type = NULL;
+        char *params = NULL;
+        struct dm_task *dmt = NULL;
+
+        if ((dmt = dm_task_create(DM_DEVICE_STATUS)) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            return -1;
+        }
+        if (dm_task_set_name(dmt, pool_name) && dm_task_run(dmt)) {
+            dm_get_next_target(dmt, NULL, &start, &length, &type, &params);
+            if (type && params) {
+                snprintf(line, sizeof(line), "%llu %llu %s %s", (unsigned long long)start, (unsigned long long)length, type, params);
+                thin_pool_parse_status(line, status);
+            }
+        }
+        dm_task_destroy(dmt);
+        return (status->found ? 0 : -1);
+    }
+#endif /* HAVE_LIBDEVMAPPER */
+
+    euca_execlp_log(NULL, thin_pool_parse_status, status, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "status", pool_name, NULL);
+    return (status->found ? 0 : -1);
+}
+
+//!
+//! Sets the name of the device mapper device of the thin pool of a store
+//!
+//! @param[in]  bs
+//! @param[out] name
+//! @param[in]  name_size
+//!
+static void thin_pool_name(const blobstore * bs, char *name, int name_size)
+{
+    snprintf(name, name_size, "euca-pool-%s", bs->id);
+}
+
+//!
+//! Creates a sparse backing file for the thin pool, if it does not exist yet, and attaches it
+//! to a loop device unless the one recorded for it is still attached to it
+//!
+//! @param[in]     path
+//! @param[in]     size_bytes the size to give to the file if it needs creating
+//! @param[in,out] lodev the loop device recorded for the file, if any, and then the one it is attached to
+//! @param[in]     lodev_size
+//!
+//! @return the size of the file in bytes, or -1 on error
+//!
+static long long thin_pool_attach_file(const char *path, long long size_bytes, char *lodev, int lodev_size)
+{
+    int fd = -1;
+    struct stat sb = { 0 };
+
+    if (stat(path, &sb) == -1) {
+        if (((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, BLOBSTORE_FILE_PERM)) == -1) || (ftruncate(fd, size_bytes) == -1)) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            if (fd != -1) {
+                close(fd);
+                unlink(path);
+            }
+            return -1;
+        }
+        close(fd);
+        sb.st_size = size_bytes;
+    }
+
+    if ((lodev[0] == '\0') || diskutil_loop_check(path, lodev)) {
+        if (diskutil_loop(path, 0, lodev, lodev_size) != EUCA_OK) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to attach a thin pool file to a loop device");
+            return -1;
+        }
+    }
+    return sb.st_size;
+}
+
+//!
+//! Makes sure the thin pool of a store is up, setting it up on the first use: its data and metadata
+//! files are created in the store directory, attached to loop devices, and a thin-pool device
+//! is made of them. After a reboot the same files, and with them all the thin devices that
+//! were allocated before, are brought back into a pool. The pool state file is locked
+//! throughout, so that concurrent users do not race to set the pool up.
+//!
+//! @param[in]  bs
+//! @param[out] pool_name name of the pool device, if not NULL
+//! @param[in]  pool_name_size
+//! @param[in]  new_thin_id if not NULL, a thin device is created in the pool, and its ID is placed here
+//!
+//! @return 0 on success or -1 on error
+//!
+static int thin_pool_ensure(const blobstore * bs, char *pool_name, int pool_name_size, int *new_thin_id)
+{
+    int fd = -1;
+    int ret = 0;
+    int size = 0;
+    int next_id = 0;
+    int tries = 0;
+    char *val = NULL;
+    char buf[1024] = "";
+    char id_str[32] = "";
+    char name[MAX_DM_NAME] = "";
+    char path[PATH_MAX] = "";
+    char data_path[PATH_MAX] = "";
+    char meta_path[PATH_MAX] = "";
+    char data_lodev[EUCA_MAX_PATH] = "";
+    char meta_lodev[EUCA_MAX_PATH] = "";
+    char dm_table[MAX_DM_LINE] = "";
+    long long data_bytes = 0;
+    long long meta_bytes = 0;
+    unsigned long long fs_bytes_size = 0;
+    unsigned long long fs_bytes_available = 0;
+    int fs_id = 0;
+    struct stat sb = { 0 };
+
+    thin_pool_name(bs, name, sizeof(name));
+    if (pool_name)
+        euca_strncpy(pool_name, name, pool_name_size);
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_POOL_FILE);
+    if (stat(path, &sb) == -1)
+        fd = open_and_lock(path, BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM);
+    if ((fd == -1) && ((fd = open_and_lock(path, BLOBSTORE_FLAG_RDWR, BLOBSTORE_METADATA_TIMEOUT_USEC, BLOBSTORE_FILE_PERM)) == -1))
+        return -1;
+
+    if ((size = fd_to_buf(fd, buf, sizeof(buf) - 1)) == -1) {
+        ret = -1;
+        goto unlock;
+    }
+    buf[size] = '\0';
+    if ((val = get_val(buf, "data")) != NULL)
+        euca_strncpy(data_lodev, val, sizeof(data_lodev));
+    EUCA_FREE(val);
+    if ((val = get_val(buf, "meta")) != NULL)
+        euca_strncpy(meta_lodev, val, sizeof(meta_lodev));
+    EUCA_FREE(val);
+    if ((val = get_val(buf, "next_id")) != NULL)
+        next_id = atoi(val);
+    EUCA_FREE(val);
+
+    if (dm_check_device(name)) {
+        // the pool data file can take up what the store may use, short of more than the file system has
+        data_bytes = (bs->limit_blocks < (LLONG_MAX / 512)) ? (bs->limit_blocks * 512) : LLONG_MAX;    // the work store may be unlimited
+        if ((statfs_path(bs->path, &fs_bytes_size, &fs_bytes_available, &fs_id) == EUCA_OK) && (fs_bytes_size < (unsigned long long)data_bytes))
+            data_bytes = fs_bytes_size;
+
+        snprintf(data_path, sizeof(data_path), "%s/%s", bs->path, BLOBSTORE_POOL_DATA_FILE);
+        snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_POOL_META_FILE);
+        if ((data_bytes = thin_pool_attach_file(data_path, data_bytes, data_lodev, sizeof(data_lodev))) == -1) {
+            ret = -1;
+            goto unlock;
+        }
+        // about 64 bytes of metadata for every data block, rounded to 4K metadata blocks
+        meta_bytes = ((data_bytes / (BLOBSTORE_POOL_BLOCK_SECTORS * 512)) * 64 + 4095) & ~4095LL;
+        if (meta_bytes < BLOBSTORE_POOL_MIN_META_BYTES)
+            meta_bytes = BLOBSTORE_POOL_MIN_META_BYTES;
+        if ((meta_bytes = thin_pool_attach_file(meta_path, meta_bytes, meta_lodev, sizeof(meta_lodev))) == -1) {
+            ret = -1;
+            goto unlock;
+        }
+
+        snprintf(dm_table, sizeof(dm_table), "0 %lld thin-pool %s %s %d 0\n", ((data_bytes / 512) / BLOBSTORE_POOL_BLOCK_SECTORS) * BLOBSTORE_POOL_BLOCK_SECTORS,
+                 meta_lodev, data_lodev, BLOBSTORE_POOL_BLOCK_SECTORS);
+        char *dm_names[1] = { name };
+        char *dm_tables[1] = { dm_table };
+        LOGINFO("setting up thin pool %s for blobstore %s\n", name, bs->path);
+        if (dm_create_devices(dm_names, dm_tables, 1)) {
+            ret = -1;
+            goto unlock;
+        }
+    }
+
+    if (new_thin_id) {
+        // the ID is recorded right away, so a pool whose state file was lost can only cost some retries
+        for (tries = 0, ret = -1; (tries < 10) && (ret == -1); tries++) {
+            if ((next_id < 0) || (next_id > BLOBSTORE_POOL_MAX_THIN_ID))
+                next_id = 0;
+            snprintf(id_str, sizeof(id_str), "%d", next_id);
+            _err_off();                // the ID may be taken, if the state file was lost
+            ret = dm_message_device(name, "create_thin", id_str);
+            _err_on();
+            *new_thin_id = next_id++;
+        }
+        if (ret == -1)
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to create a thin device in the thin pool");
+    }
+
+    snprintf(buf, sizeof(buf), "data: %s\n" "meta: %s\n" "next_id: %d\n", data_lodev, meta_lodev, next_id);
+    if ((ftruncate(fd, 0) == -1) || (buf_to_fd(fd, buf, strlen(buf)) != strlen(buf))) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to record the state of the thin pool");
+        ret = -1;
+    }
+
+unlock:
+    if (close_and_unlock(fd) != 0)
+        ret = -1;
+    return ret;
+}
+
+//!
+//! Deletes thin devices from the thin pool of a store, after their device mapper devices have
+//! been removed
+//!
+//! @param[in] bs
+//! @param[in] ids the IDs of the thin devices, as strings
+//! @param[in] ids_size
+//!
+//! @return 0 on success or -1 if any of the devices could not be deleted
+//!
+static int thin_pool_delete_ids(const blobstore * bs, char **ids, int ids_size)
+{
+    int ret = 0;
+    char name[MAX_DM_NAME] = "";
+
+    if (ids_size < 1)
+        return 0;
+
+    if (thin_pool_ensure(bs, name, sizeof(name), NULL) == -1)
+        return -1;
+
+    for (int i = 0; i < ids_size; i++) {
+        if (dm_message_device(name, "delete", ids[i]) == -1)
+            ret = -1;
+    }
+    return ret;
+}
+
+//!
+//! Tears down the thin pool of a store and deletes its files, which drops all thin devices in it
+//!
+//! @param[in] bs
+//!
+static void thin_pool_destroy(const blobstore * bs)
+{
+    int size = 0;
+    int fd = -1;
+    char *val = NULL;
+    char buf[1024] = "";
+    char name[MAX_DM_NAME] = "";
+    char path[PATH_MAX] = "";
+    char *dm_names[1] = { name };
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_POOL_FILE);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return;                        // the store never had a pool
+
+    thin_pool_name(bs, name, sizeof(name));
+    dm_delete_devices(dm_names, 1);
+
+    if ((size = fd_to_buf(fd, buf, sizeof(buf) - 1)) > 0) {
+        buf[size] = '\0';
+        if (((val = get_val(buf, "data")) != NULL) && (val[0] != '\0'))
+            diskutil_unloop(val);
+        EUCA_FREE(val);
+        if (((val = get_val(buf, "meta")) != NULL) && (val[0] != '\0'))
+            diskutil_unloop(val);
+        EUCA_FREE(val);
+    }
+    close(fd);
+
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_POOL_DATA_FILE);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_POOL_META_FILE);
+    unlink(path);
+}
+
 //!
-static int blockblob_check(const blockblob * bb)
+//! Looks for inconsistencies in the state of a blob
+//!
+//! @param[in] bb
+//! @param[in] check_devices set to TRUE to check the dm and loop devices of the blob, too, which is
+//!            by far the slowest part as it runs 'dmsetup' and 'losetup'
+//!
+//! @return the number of problems found
+//!
+static int blockblob_check(const blockblob * bb, int check_devices)
 {
     char **array = NULL;
     int array_size = 0;
     int err = 0;
     _err_off();                        // do not care if metadata files do not exist
 
+    if (!check_devices)
+        goto relations;
+
     // check on dm devices listed in .dm of this blob, if any
     if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) != -1) {
         for (int i = 0; i < array_size; i++) {
@@ -3771,6 +7051,8 @@ static int blockblob_check(const blockblob * bb)
             err++;
         }
     }
+
+relations:
     // check on .refs that point to blobs that no longer exist
     if (get_stale_refs(bb, NULL) > 0)
         err++;
@@ -3784,24 +7066,25 @@ static int blockblob_check(const blockblob * bb)
 }
 
 //!
+//! Tears down the devices of a blob, drops it from the blobs it depends on and deletes its files.
+//! The devices and the loopback are the blob's own, so, unless the caller holds the store lock
+//! already, the lock is only taken once they are gone, for updating the metadata shared with
+//! other blobs and for deleting the files.
 //!
-//!
-//! @param[in] bb
+//! @param[in] bb a blob that the caller has locked
 //! @param[in] timeout_usec
 //! @param[in] do_force
+//! @param[in] have_store_lock TRUE if the caller holds the store lock
 //!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success or -1 on error
 //!
-static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force)
+static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_force, char have_store_lock)
 {
     blobstore *bs = bb->store;
     char **array = NULL;
     int array_size = 0;
     int ret = 0;
+    int locked = 0;
 
     // delete dm devices listed in .dm of this blob
     if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, &array, &array_size) == -1 || dm_delete_devices(array, array_size) == -1) {
@@ -3813,9 +7096,43 @@ static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_for
     for (int i = 0; i < array_size; i++) {
         EUCA_FREE(array[i]);
     }
-    EUCA_FREE(array);
-    array_size = 0;
-    array = NULL;
+    EUCA_FREE(array);
+    array_size = 0;
+    array = NULL;
+
+    // with the devices gone, delete thin devices listed in .thin from the pool
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_THIN, bb->store, bb->id, &array, &array_size) != -1 && array_size > 0) {
+        if (thin_pool_delete_ids(bs, array, array_size) == -1) {
+            if (!do_force) {
+                ret = -1;
+                goto free;
+            }
+        }
+        write_blockblob_metadata_path(BLOCKBLOB_PATH_THIN, bb->store, bb->id, "");
+    }
+    for (int i = 0; i < array_size; i++) {
+        EUCA_FREE(array[i]);
+    }
+    EUCA_FREE(array);
+    array_size = 0;
+    array = NULL;
+
+    // remove the loopback entry for this blob
+    if (loop_remove(bs, bb->id) == -1) {
+        ret = -1;
+    }
+
+    if (!have_store_lock) {
+        if (blobstore_lock(bs, timeout_usec) == -1) {
+            if (!do_force) {
+                ret = -1;
+                goto free;
+            }
+            LOGWARN("deleting blob %s without the lock on store %s\n", bb->id, bs->path);
+        } else {
+            locked = 1;
+        }
+    }
 
     // Read in .deps (blobs that this blob depends on),
     // so as to update their .refs (blobs depending on them).
@@ -3861,10 +7178,6 @@ static int delete_blob_state(blockblob * bb, long long timeout_usec, char do_for
         }
     }
 
-    // remove the loopback entry for this blob
-    if (loop_remove(bs, bb->id) == -1) {
-        ret = -1;
-    }
     // remove the files, data and metadata, for of this blob
     if (delete_blockblob_files(bs, bb->id) < 1) {
         ret = -1;
@@ -3876,6 +7189,15 @@ free:
     }
     EUCA_FREE(array);
 
+    if (locked) {
+        blobstore_error_t saved_errno = _blobstore_errno;  // save it because blobstore_unlock may overwrite it
+        if (blobstore_unlock(bs) == -1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+        }
+        if (saved_errno) {
+            _blobstore_errno = saved_errno;
+        }
+    }
     return ret;
 }
 
@@ -3903,17 +7225,20 @@ int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force)
     }
     blobstore *bs = bb->store;
     int ret = 0;
-    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so we can traverse it
+    if (blobstore_lock(bs, timeout_usec) == -1) {   // lock it so that no one maps the blob while we look
         return -1;                     // failed to obtain a lock on the blobstore
     }
     // do not delete the blob if it is used by another one
     bb->in_use = check_in_use(bs, bb->id, 0);   // update in_use status
+    if (blobstore_unlock(bs) == -1) {   // we have the blob locked, so the rest can go without the store lock
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
+    }
     // if in use other than opened (by this thread), backed, or abandoned
     if (!do_force && (bb->in_use & ~(BLOCKBLOB_STATUS_OPENED | BLOCKBLOB_STATUS_BACKED | BLOCKBLOB_STATUS_ABANDONED))) {
         ERR(BLOBSTORE_ERROR_AGAIN, NULL);
         ret = -1;
     } else {
-        ret = delete_blob_state(bb, timeout_usec, do_force);    // do the bulk of the cleanup
+        ret = delete_blob_state(bb, timeout_usec, do_force, FALSE); // do the bulk of the cleanup
 
         // close the open file descriptors
         if (ftruncate(bb->fd_lock, 0) != 0) {
@@ -3938,15 +7263,6 @@ int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force)
         }
     }
 
-    int saved_errno = 0;
-    saved_errno = _blobstore_errno;    // save it because blobstore_unlock may overwrite it
-    if (blobstore_unlock(bs) == -1) {
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
-    }
-    if (saved_errno) {
-        _blobstore_errno = saved_errno;
-    }
-
     return ret;
 }
 
@@ -4043,7 +7359,7 @@ int blockblob_copy(blockblob * src_bb, unsigned long long src_offset_bytes, bloc
     const char *src_path = (src_bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) ? (blockblob_get_dev(src_bb)) : (blockblob_get_file(src_bb));
     const char *dst_path = (dst_bb->snapshot_type == BLOBSTORE_SNAPSHOT_DM) ? (blockblob_get_dev(dst_bb)) : (blockblob_get_file(dst_bb));
     mode_t old_umask = umask(~BLOBSTORE_FILE_PERM);
-    int error = diskutil_dd2(src_path, dst_path, granularity, copy_len_bytes / granularity, dst_offset_bytes / granularity, src_offset_bytes / granularity);
+    int error = diskutil_copy(src_path, dst_path, granularity, copy_len_bytes / granularity, dst_offset_bytes / granularity, src_offset_bytes / granularity);
     umask(old_umask);
     if (error) {
         ERR(BLOBSTORE_ERROR_INVAL, "failed to copy a section");
@@ -4189,6 +7505,25 @@ static char *dm_sort_table(char **pOldTable)
 //! @note
 //!
 int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
+{
+    int ret = 0;
+
+    EUCA_PROBE2(blob__clone__start, ((bb != NULL) ? bb->id : NULL), map_size);
+    ret = clone_blockblob(bb, map, map_size);
+    EUCA_PROBE2(blob__clone__done, ((bb != NULL) ? bb->id : NULL), ret);
+    return ret;
+}
+
+//!
+//! Does the work of blockblob_clone()
+//!
+//! @param[in] bb pointer to destination blob, which blocks may be used as backing
+//! @param[in] map pointer to map of blocks from other blobs/devices to be copied/mapped/snapshotted
+//! @param[in] map_size size of the map[]
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int clone_blockblob(blockblob * bb, const blockmap * map, unsigned int map_size)
 {
     int ret = 0;
     if (bb == NULL) {
@@ -4206,7 +7541,7 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
     char *zero_dev = NULL;
     for (int i = 0; i < map_size; i++) {
         const blockmap *m = map + i;
-        if (m->relation_type != BLOBSTORE_COPY && bb->store->snapshot_policy != BLOBSTORE_SNAPSHOT_DM) {
+        if (m->relation_type != BLOBSTORE_COPY && bb->store->snapshot_policy != BLOBSTORE_SNAPSHOT_DM && bb->store->snapshot_policy != BLOBSTORE_SNAPSHOT_THIN) {
             ERR(BLOBSTORE_ERROR_INVAL, "relation type is incompatible with snapshot policy");
             return -1;
         }
@@ -4277,6 +7612,8 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
 
     int devices = 0;
     int mapped_or_snapshotted = 0;
+    int thin_ids_size = 0;
+    int thin_ids_live = 0;             // whether devices using the thin IDs are up, so the IDs cannot be dropped
     char buf[MAX_DM_LINE];
     char *main_dm_table = NULL;
     char **dev_names = EUCA_ZALLOC(map_size * 4 + 1, sizeof(char *));   // for device mapper dev names we will create
@@ -4290,6 +7627,13 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
         EUCA_FREE(dev_names);
         return -1;
     }
+    char **thin_ids = EUCA_ZALLOC(map_size + 1, sizeof(char *));    // for IDs of thin devices we will allocate in the pool
+    if (thin_ids == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        EUCA_FREE(dev_names);
+        EUCA_FREE(dm_tables);
+        return -1;
+    }
     // either does copies or computes the device mapper tables
     for (int i = 0; i < map_size; i++) {
         const blockmap *m = map + i;
@@ -4315,7 +7659,7 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
         switch (m->relation_type) {
         case BLOBSTORE_COPY:
             // do the copy
-            if (diskutil_dd2(dev, bb->device_path, 512, m->len_blocks, m->first_block_dst, m->first_block_src)) {
+            if (diskutil_copy(dev, bb->device_path, 512, m->len_blocks, m->first_block_dst, m->first_block_src)) {
                 ERR(BLOBSTORE_ERROR_INVAL, "failed to copy a section");
                 ret = -1;
                 goto free;
@@ -4325,7 +7669,49 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
             main_dm_table = euca_strdupcat(main_dm_table, buf);
             break;
 
-        case BLOBSTORE_SNAPSHOT:{
+        case BLOBSTORE_SNAPSHOT:
+            if (bb->store->snapshot_policy == BLOBSTORE_SNAPSHOT_THIN) {
+                int thin_id = 0;
+                char pool_name[MAX_DM_NAME] = "";
+
+                // a thin device can only use an entire device as its external origin, so offsets need a map, too
+                const char *origin_dev = dev;
+                if (m->first_block_src > 0 && m->source_type != BLOBSTORE_ZERO) {
+                    snprintf(buf, sizeof(buf), "%s-p%d-real", dm_base, i);
+                    dev_names[devices] = strdup(buf);
+                    origin_dev = dev_names[devices];
+                    snprintf(buf, sizeof(buf), "0 %lld linear %s %lld\n", m->len_blocks, ((dev) ? dev : 0), m->first_block_src);
+                    dm_tables[devices] = strdup(buf);
+                    devices++;
+                }
+                // allocate a thin device in the pool of the store, setting up the pool if this is its first use
+                if (thin_pool_ensure(bb->store, pool_name, sizeof(pool_name), &thin_id) == -1) {
+                    ret = -1;
+                    goto free;
+                }
+                snprintf(buf, sizeof(buf), "%d", thin_id);
+                thin_ids[thin_ids_size++] = strdup(buf);
+
+                // Blocks of the thin device that were never written are read from the origin, while
+                // writes are provisioned from the pool and never touch the origin. Zero sources
+                // need no origin, since the pool reads unprovisioned blocks as zeros.
+                snprintf(buf, sizeof(buf), "%s-p%d-thin", dm_base, i);
+                dev_names[devices] = strdup(buf);
+                dev = dev_names[devices];
+                if (m->source_type == BLOBSTORE_ZERO) {
+                    snprintf(buf, sizeof(buf), "0 %lld thin " DM_PATH "%s %d\n", m->len_blocks, pool_name, thin_id);
+                } else {
+                    snprintf(buf, sizeof(buf), "0 %lld thin " DM_PATH "%s %d %s%s\n", m->len_blocks, pool_name, thin_id, origin_dev[0] == 'e' ? DM_PATH : "",
+                             origin_dev);
+                }
+                dm_tables[devices] = strdup(buf);
+                devices++;
+
+                first_block_src = 0;   // for thin snapshots the mapping goes from the -thin device at offset 0
+                goto map;
+            }
+
+            {
                 int granularity = 16;  // coarser granularity does not work
                 while (m->len_blocks % granularity) {   // do we need to do this?
                     granularity /= 2;
@@ -4367,6 +7753,7 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
             }
 
         case BLOBSTORE_MAP:
+map:
             // append to the main dm table
             snprintf(buf, sizeof(buf), "%lld %lld linear %s%s %lld\n", m->first_block_dst, m->len_blocks, dev[0] == 'e' ? DM_PATH : "", dev, first_block_src);
             main_dm_table = euca_strdupcat(main_dm_table, buf);
@@ -4398,11 +7785,18 @@ int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size)
             ret = -1;
             goto free;
         }
+        thin_ids_live = 1;
+
         // record new devices in .dm of this blob
         if (write_array_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, dev_names, devices) == -1) {
             ret = -1;
             goto cleanup;
         }
+        // and the thin devices they use in .thin, which get deleted from the pool along with them
+        if (thin_ids_size > 0 && write_array_blockblob_metadata_path(BLOCKBLOB_PATH_THIN, bb->store, bb->id, thin_ids, thin_ids_size) == -1) {
+            ret = -1;
+            goto cleanup;
+        }
         bb->snapshot_type = BLOBSTORE_SNAPSHOT_DM;  // remember that blobstore uses device mapper
 
         // update .refs on dependencies and create .deps for this blob
@@ -4457,16 +7851,29 @@ cleanup:                              // this is failure cleanup code path
         // remove dm devices that may have been created
         if (dm_delete_devices(dev_names, devices) == 0) {
 
-            // remove the .dm file so that others do not
+            // clear the .dm field so that others do not
             // needlessly attempt to remove dm devices later
-            char path[PATH_MAX];
-            set_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, path, sizeof(path));
-            unlink(path);
+            write_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bb->store, bb->id, "");
+            write_blockblob_metadata_path(BLOCKBLOB_PATH_THIN, bb->store, bb->id, "");
+            thin_ids_live = 0;
         }
         _blobstore_errno = saved_errno;
     }
 
 free:
+    // thin devices allocated in the pool for a clone that did not come about hold on to pool space
+    if (ret == -1 && !thin_ids_live && thin_ids_size > 0) {
+        int saved_errno = _blobstore_errno;
+        _err_off();
+        thin_pool_delete_ids(bb->store, thin_ids, thin_ids_size);
+        _err_on();
+        _blobstore_errno = saved_errno;
+    }
+    for (int i = 0; i < thin_ids_size; i++) {
+        EUCA_FREE(thin_ids[i]);
+    }
+    EUCA_FREE(thin_ids);
+
     // Only free main_dm_table if mapped_or_snapshotted is 0. If its greater than
     // 0, it would be assigned to the dm_tables array.
     if (mapped_or_snapshotted == 0) {
@@ -4569,6 +7976,81 @@ int blockblob_get_dir(blockblob * bb, char *buf, int buflen)
     return -1;
 }
 
+//!
+//! Reads the signature that the blob was created with, so that a copy of it can be created
+//! with the same one
+//!
+//! @param[in]  bb the blob
+//! @param[out] buf where the signature goes, as a string, empty if the blob has none
+//! @param[in]  buflen size of buf
+//!
+//! @return the length of the signature or -1 on failure
+//!
+int blockblob_get_sig(blockblob * bb, char *buf, int buflen)
+{
+    int len = 0;
+
+    if ((bb == NULL) || (buf == NULL) || (buflen < 1)) {
+        ERR(BLOBSTORE_ERROR_INVAL, NULL);
+        return -1;
+    }
+
+    buf[0] = '\0';
+    _err_off();                        // a blob without a signature is not an error
+    len = read_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bb->store, bb->id, buf, buflen);
+    _err_on();
+    if (len < 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+    if (len >= buflen) {
+        buf[0] = '\0';
+        ERR(BLOBSTORE_ERROR_INVAL, "signature does not fit");
+        return -1;
+    }
+    return len;
+}
+
+//!
+//! Records that a blob is backed by another without mapping any of its blocks, as a qcow2
+//! overlay is by its backing file, so that the backing blob is neither purged nor deleted
+//! for as long as this blob exists. Deleting this blob removes the relation.
+//!
+//! @param[in] bb the overlay blob, which must be open
+//! @param[in] backing the blob that it reads from, which must be open
+//!
+//! @return success (0) or failure (-1)
+//!
+int blockblob_add_backing(blockblob * bb, blockblob * backing)
+{
+    int ret = 0;
+    char my_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1] = "";
+    char dep_ref[BLOBSTORE_MAX_PATH + MAX_DM_NAME + 1] = "";
+
+    if ((bb == NULL) || (backing == NULL)) {
+        ERR(BLOBSTORE_ERROR_INVAL, NULL);
+        return -1;
+    }
+
+    snprintf(my_ref, sizeof(my_ref), "%s %s", bb->store->path, bb->id);
+    if (blobstore_lock(backing->store, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // so the .refs are updated atomically
+        LOGERROR("{%u} error: timed out on a blobstore lock while attempting to update .refs\n", (unsigned int)pthread_self());
+        return -1;
+    }
+    ret = update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, backing->store, backing->id, my_ref, 0);
+    if (blobstore_unlock(backing->store) == -1)
+        ret = -1;
+    if (ret == -1)
+        return -1;
+
+    // a snapshot relation, since the overlay takes the blocks it does not write from the backing
+    snprintf(dep_ref, sizeof(dep_ref), "%s %s %s %llu %llu", backing->store->path, backing->id, blobstore_relation_type_name[BLOBSTORE_SNAPSHOT], 0ULL,
+             round_up_sec(backing->size_bytes) / 512);
+    if (update_entry_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, dep_ref, 0) == -1)
+        return -1;
+    return 0;
+}
+
 //!
 //!
 //!
@@ -4660,20 +8142,30 @@ static void _fill_blob(blockblob * bb, char c, int use_file)
         path = blockblob_get_dev(bb);
     }
 
-    char buf[1];
-    buf[0] = c;
+    char buf[64 * 1024];
+    memset(buf, c, sizeof(buf));
 
     printf("filling out with dummy data %s\n", path);
     int fd = open(path, O_WRONLY);
-    int failed_bytes = 0;
+    long long failed_bytes = 0;
     if (fd != -1) {
-        for (int i = 0; i < bb->size_bytes; i++) {
-            if (write(fd, buf, 1) != 1)
-                failed_bytes++;
+        // through the I/O engine when the kernel has one, with plain writes otherwise
+        diskutil_io *io = diskutil_io_open(-1, fd);
+        if ((io == NULL) || (diskutil_io_fill(io, 0, bb->size_bytes, c) != EUCA_OK)) {
+            for (long long done = 0; done < bb->size_bytes;) {
+                long long chunk = (((bb->size_bytes - done) < sizeof(buf)) ? (bb->size_bytes - done) : sizeof(buf));
+                ssize_t wrote = pwrite(fd, buf, chunk, done);
+                if (wrote <= 0) {
+                    failed_bytes = bb->size_bytes - done;
+                    break;
+                }
+                done += wrote;
+            }
         }
+        diskutil_io_close(&io);
     }
     if (failed_bytes) {
-        printf("WARNING: failed to fill %d byte(s) to path %s\n", failed_bytes, path);
+        printf("WARNING: failed to fill %lld byte(s) to path %s\n", failed_bytes, path);
     }
     if (fd >= 0) {
         fsync(fd);
@@ -5330,6 +8822,31 @@ static int do_metadata_test(const char *base, const char *name)
         _BADMETACMD;                   // read file
     if (strcmp(buf, _STR2))
         _BADMETACMD;
+
+    // metadata left in separate files by an older layout gets read and then migrated into .meta
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_META, bs, bb1->id, entry_path, sizeof(entry_path));
+    unlink(entry_path);
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb1->id, entry_path, sizeof(entry_path));
+    FILE *fp = fopen(entry_path, "w");
+    if (fp) {
+        fputs(_STR2, fp);
+        fclose(fp);
+    }
+    /* 18 */ if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb1->id, &array, &array_size) != 0 || array_size != 3)
+        _BADMETACMD;                   // read legacy file line-by-line
+    for (int i = 0; i < array_size; i++) {
+        EUCA_FREE(array[i]);
+    }
+    EUCA_FREE(array);
+    if (write_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb1->id, _STR1) != 0)
+        _BADMETACMD;                   // first write migrates
+    /* 20 */ if (access(entry_path, F_OK) == 0)
+        _BADMETACMD;                   // legacy file is gone
+    if (read_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb1->id, buf, sizeof(buf)) != strlen(_STR2) || strcmp(buf, _STR2))
+        _BADMETACMD;                   // its contents were carried over
+    if (read_blockblob_metadata_path(BLOCKBLOB_PATH_SIG, bs, bb1->id, buf, sizeof(buf)) != strlen(_STR1) || strcmp(buf, _STR1))
+        _BADMETACMD;
+    write_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb1->id, "");
     _CLOSBB(bb1, B1);
 
     blobstore_close(bs);
@@ -5729,6 +9246,429 @@ static void dummy_err_fn(const char *msg)
 {
 }
 
+#ifdef _BENCHMARK
+//!
+//! Microseconds on the monotonic clock
+//!
+//! @return the current time in microseconds
+//!
+static long long bench_usec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000);
+}
+
+//!
+//! Records the outcome of one benchmarked call
+//!
+//! @param[in,out] s the samples of the operation
+//! @param[in]     usec latency of the call
+//! @param[in]     ok set to TRUE if the call succeeded
+//!
+static void bench_add(bench_samples * s, long long usec, int ok)
+{
+    long long *grown = NULL;
+
+    if (!ok) {
+        s->failed++;
+        return;
+    }
+
+    if (s->len == s->size) {
+        if ((grown = EUCA_REALLOC(s->usec, ((s->size * 2) + 64), sizeof(long long))) == NULL) {
+            s->failed++;
+            return;
+        }
+        s->usec = grown;
+        s->size = (s->size * 2) + 64;
+    }
+    s->usec[s->len++] = usec;
+}
+
+//!
+//! Adds the samples of 'from' to 'to' and releases those of 'from'
+//!
+//! @param[in,out] to
+//! @param[in,out] from
+//!
+static void bench_merge(bench_samples * to, bench_samples * from)
+{
+    for (int i = 0; i < from->len; i++)
+        bench_add(to, from->usec[i], TRUE);
+    to->failed += from->failed;
+    EUCA_FREE(from->usec);
+    bzero(from, sizeof(bench_samples));
+}
+
+//!
+//! qsort() comparator of latencies
+//!
+static int bench_compare(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints one result line and resets the samples. Every line starts with 'blobstore_bench'
+//! and only holds key=value pairs, so results can be told apart from the progress output
+//! of the blobstore and compared across runs with standard tools.
+//!
+//! @param[in]     out stream to print to
+//! @param[in]     op name of the operation
+//! @param[in]     config key=value pairs describing the configuration
+//! @param[in]     threads number of threads that made the calls
+//! @param[in,out] s the samples, with elapsed_usec set to the wall-clock time of the phase
+//!
+static void bench_report(FILE * out, const char *op, const char *config, int threads, bench_samples * s)
+{
+    long long total = 0;
+
+    if ((s->len + s->failed) == 0)
+        return;
+
+    qsort(s->usec, s->len, sizeof(long long), bench_compare);
+    for (int i = 0; i < s->len; i++)
+        total += s->usec[i];
+
+#define _PCT(_F)                       ((s->len > 0) ? s->usec[MIN(s->len - 1, (int)((_F) * s->len))] : 0LL)
+    fprintf(out, "blobstore_bench op=%s %s threads=%d calls=%d failed=%d ops_per_sec=%.1f mean_us=%lld p50_us=%lld p90_us=%lld p99_us=%lld max_us=%lld\n",
+            op, config, threads, s->len + s->failed, s->failed, ((s->elapsed_usec > 0) ? (s->len * 1000000.0 / s->elapsed_usec) : 0.0),
+            ((s->len > 0) ? (total / s->len) : 0LL), _PCT(0.50), _PCT(0.90), _PCT(0.99), _PCT(1.0));
+#undef _PCT
+    fflush(out);
+
+    EUCA_FREE(s->usec);
+    bzero(s, sizeof(bench_samples));
+}
+
+//!
+//! Thread of the concurrent open/close phase: opens and closes random blobs of the store
+//!
+//! @param[in] ptr the bench_worker of this thread
+//!
+//! @return Always NULL
+//!
+static void *bench_open_close(void *ptr)
+{
+    int rc = 0;
+    long long start = 0;
+    char id[BLOBSTORE_MAX_PATH] = "";
+    blockblob *bb = NULL;
+    bench_worker *w = ((bench_worker *) ptr);
+
+    for (int i = 0; i < w->ops; i++) {
+        snprintf(id, sizeof(id), "bench-%07d", (rand_r(&(w->seed)) % w->count));
+        start = bench_usec();
+        bb = blockblob_open(w->bs, id, 0, 0, NULL, BENCH_TIMEOUT_USEC);
+        bench_add(&(w->open), (bench_usec() - start), (bb != NULL));
+        if (bb) {
+            start = bench_usec();
+            rc = blockblob_close(bb);
+            bench_add(&(w->close), (bench_usec() - start), (rc == 0));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Benchmarks one store configuration: creation of 'count' blobs, opens and closes at each
+//! concurrency level, copies, clones, full searches, deletions and, last, creations that
+//! only succeed by purging the least recently used blobs
+//!
+//! @param[in] out stream to print the results to
+//! @param[in] base directory in which the store is created
+//! @param[in] snapshot snapshot policy of the store, which decides how clones are made
+//! @param[in] snapshot_name name of the policy, for the results
+//! @param[in] count number of blobs in the store
+//! @param[in] threads concurrency levels of the open/close phase
+//! @param[in] threads_len number of entries in threads[]
+//!
+//! @return the number of errors
+//!
+static int bench_store(FILE * out, const char *base, blobstore_snapshot_t snapshot, const char *snapshot_name, int count, const int *threads, int threads_len)
+{
+    int rc = 0;
+    int errors = 0;
+    int copies = MIN(count, BENCH_CLONES);
+    int extra = MAX(1, (count * BENCH_PRESSURE_PERCENT) / 100);
+    long long start = 0;
+    long long phase = 0;
+    char id[BLOBSTORE_MAX_PATH] = "";
+    char config[128] = "";
+    blobstore *bs = NULL;
+    blockblob *bb = NULL;
+    blockblob *src = NULL;
+    blockblob_meta *matches = NULL;
+    blockblob_meta *next = NULL;
+    bench_samples s = { 0 };
+    bench_samples s2 = { 0 };
+    bench_worker *workers = NULL;
+
+    snprintf(config, sizeof(config), "snapshot=%s blobs=%d blob_blocks=%d", snapshot_name, count, BENCH_BLOB_BLOCKS);
+    if ((bs = create_teststore(((count + (2 * copies)) * BENCH_BLOB_BLOCKS), base, "bench", BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, snapshot)) == NULL) {
+        // the snapshot policies need device mapper, so they are only an error when copying fails, too
+        fprintf(out, "blobstore_bench op=setup %s skipped=1\n", config);
+        return ((snapshot == BLOBSTORE_SNAPSHOT_NONE) ? 1 : 0);
+    }
+#define _BENCH_CREATE(_ID)                   blockblob_open(bs, (_ID), (BENCH_BLOB_BLOCKS * 512), (BLOBSTORE_FLAG_CREAT | BLOBSTORE_FLAG_EXCL), NULL, BENCH_TIMEOUT_USEC)
+#define _BENCH_OPEN(_ID)                     blockblob_open(bs, (_ID), 0, 0, NULL, BENCH_TIMEOUT_USEC)
+
+    // creation of an empty store up to its working size
+    phase = bench_usec();
+    for (int i = 0; i < count; i++) {
+        snprintf(id, sizeof(id), "bench-%07d", i);
+        start = bench_usec();
+        bb = _BENCH_CREATE(id);
+        bench_add(&s, (bench_usec() - start), (bb != NULL));
+        if (bb == NULL) {
+            errors++;
+            goto drain;
+        }
+        blockblob_close(bb);
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    bench_report(out, "create", config, 1, &s);
+
+    // opens and closes of existing blobs, at each level of concurrency
+    for (int t = 0; t < threads_len; t++) {
+        if ((workers = EUCA_ZALLOC(threads[t], sizeof(bench_worker))) == NULL) {
+            errors++;
+            goto drain;
+        }
+        phase = bench_usec();
+        for (int i = 0; i < threads[t]; i++) {
+            workers[i].bs = bs;
+            workers[i].count = count;
+            workers[i].ops = MAX(1, MIN(count, BENCH_MAX_OPS) / threads[t]);
+            workers[i].seed = random();
+            if (pthread_create(&(workers[i].thread), NULL, bench_open_close, &(workers[i])) != 0) {
+                workers[i].ops = 0;
+                errors++;
+            }
+        }
+        for (int i = 0; i < threads[t]; i++) {
+            if (workers[i].ops > 0)
+                pthread_join(workers[i].thread, NULL);
+            bench_merge(&s, &(workers[i].open));
+            bench_merge(&s2, &(workers[i].close));
+        }
+        s.elapsed_usec = s2.elapsed_usec = bench_usec() - phase;
+        errors += s.failed;
+        bench_report(out, "open", config, threads[t], &s);
+        bench_report(out, "close", config, threads[t], &s2);
+        EUCA_FREE(workers);
+    }
+
+    // copies and clones of the first blobs, timing only the data transfer or the snapshot
+    for (int clone = 0; clone < 2; clone++) {
+        blockmap map[] = {
+            {((clone && (snapshot != BLOBSTORE_SNAPSHOT_NONE)) ? BLOBSTORE_SNAPSHOT : BLOBSTORE_COPY), BLOBSTORE_BLOCKBLOB, {blob:NULL}, 0, 0, BENCH_BLOB_BLOCKS},
+        };
+        for (int i = 0; i < copies; i++) {
+            snprintf(id, sizeof(id), "bench-%07d", i);
+            if ((src = _BENCH_OPEN(id)) == NULL) {
+                errors++;
+                continue;
+            }
+            snprintf(id, sizeof(id), "bench-%s-%07d", (clone ? "clone" : "copy"), i);
+            if ((bb = _BENCH_CREATE(id)) == NULL) {
+                errors++;
+                blockblob_close(src);
+                continue;
+            }
+            map[0].source.blob = src;
+            start = bench_usec();
+            if (clone) {
+                rc = blockblob_clone(bb, map, 1);
+            } else {
+                rc = blockblob_copy(src, 0, bb, 0, (BENCH_BLOB_BLOCKS * 512));
+            }
+            bench_add(&s, (bench_usec() - start), (rc == 0));
+            s.elapsed_usec += bench_usec() - start;
+            blockblob_close(bb);
+            blockblob_close(src);
+        }
+        errors += s.failed;
+        bench_report(out, (clone ? "clone" : "copy"), config, 1, &s);
+    }
+
+    // full searches, which walk every blob of the store as scan_blobstore() does
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_SEARCHES; i++) {
+        matches = NULL;
+        start = bench_usec();
+        rc = blobstore_search(bs, "bench-.*", &matches);
+        bench_add(&s, (bench_usec() - start), (rc >= 0));
+        for (blockblob_meta * bm = matches; bm; bm = next) {
+            next = bm->next;
+            EUCA_FREE(bm);
+        }
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    bench_report(out, "search", config, 1, &s);
+
+    // deletions of the clones first, since in snapshot mode their sources depend on them
+    for (int clone = 1; clone >= 0; clone--) {
+        for (int i = 0; i < copies; i++) {
+            snprintf(id, sizeof(id), "bench-%s-%07d", (clone ? "clone" : "copy"), i);
+            if ((bb = _BENCH_OPEN(id)) == NULL)
+                continue;
+            start = bench_usec();
+            rc = blockblob_delete(bb, BENCH_TIMEOUT_USEC, 0);
+            bench_add(&s, (bench_usec() - start), (rc == 0));
+            s.elapsed_usec += bench_usec() - start;
+            if (rc != 0)
+                blockblob_close(bb);
+        }
+    }
+    bench_report(out, "delete", config, 1, &s);
+
+    // creations in a full store, each of which has to purge the least recently used blob
+    for (int i = 0; i < (copies * 2); i++) {
+        snprintf(id, sizeof(id), "bench-fill-%07d", i);
+        if ((bb = _BENCH_CREATE(id)) != NULL)
+            blockblob_close(bb);
+    }
+    phase = bench_usec();
+    for (int i = 0; i < extra; i++) {
+        snprintf(id, sizeof(id), "bench-lru-%07d", i);
+        start = bench_usec();
+        bb = _BENCH_CREATE(id);
+        bench_add(&s, (bench_usec() - start), (bb != NULL));
+        if (bb)
+            blockblob_close(bb);
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "create_lru", config, 1, &s);
+
+drain:
+#undef _BENCH_CREATE
+#undef _BENCH_OPEN
+    EUCA_FREE(s.usec);
+    EUCA_FREE(s2.usec);
+    blobstore_delete_regex(bs, "bench-.*");
+    blobstore_close(bs);
+    return (errors);
+}
+
+//!
+//! Parses a comma-separated list of positive integers
+//!
+//! @param[in]  list the list
+//! @param[out] values array receiving the integers
+//! @param[in]  size room in values[]
+//!
+//! @return the number of integers parsed or -1 if the list is invalid
+//!
+static int bench_parse_list(const char *list, int *values, int size)
+{
+    int len = 0;
+    char *end = NULL;
+    const char *p = list;
+
+    while (*p != '\0') {
+        if (len == size)
+            return (-1);
+        if (((values[len++] = strtol(p, &end, 10)) < 1) || ((*end != ',') && (*end != '\0')))
+            return (-1);
+        p = ((*end == ',') ? (end + 1) : end);
+    }
+    return (len);
+}
+
+//!
+//! Runs the blobstore benchmarks over every combination of snapshot policy and blob count.
+//!
+//! Usage: bench_blobstore [-n counts] [-t threads] [-s snapshots] [-o file], where counts and
+//! threads are comma-separated lists and snapshots is a comma-separated list of none, dm and
+//! thin. Results go to stdout or the given file, one 'blobstore_bench' line per operation.
+//!
+//! @param[in] base directory in which the stores are created
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+static int do_benchmark(const char *base, int argc, char **argv)
+{
+    int ch = 0;
+    int errors = 0;
+    int counts_len = 0;
+    int threads_len = 0;
+    int counts[16] = { 0 };
+    int threads[16] = { 0 };
+    char *saveptr = NULL;
+    char *snapshots = NULL;
+    char *snapshots_opt = BENCH_DEFAULT_SNAPSHOTS;
+    char *counts_opt = BENCH_DEFAULT_COUNTS;
+    char *threads_opt = BENCH_DEFAULT_THREADS;
+    FILE *out = stdout;
+    blobstore_snapshot_t snapshot = BLOBSTORE_SNAPSHOT_NONE;
+
+    while ((ch = getopt(argc, argv, "n:t:s:o:")) != -1) {
+        switch (ch) {
+        case 'n':
+            counts_opt = optarg;
+            break;
+        case 't':
+            threads_opt = optarg;
+            break;
+        case 's':
+            snapshots_opt = optarg;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            printf("Usage: bench_blobstore [-n counts] [-t threads] [-s none,dm,thin] [-o file]\n");
+            return (1);
+        }
+    }
+
+    if (((counts_len = bench_parse_list(counts_opt, counts, 16)) < 1) || ((threads_len = bench_parse_list(threads_opt, threads, 16)) < 1)) {
+        printf("ERROR: blob counts and thread counts must be comma-separated positive integers\n");
+        return (1);
+    }
+    for (int i = 0; i < threads_len; i++) {
+        threads[i] = MIN(threads[i], BENCH_MAX_THREADS);
+    }
+
+    if ((snapshots = strdup(snapshots_opt)) == NULL)
+        return (1);
+
+    for (char *name = strtok_r(snapshots, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+        if (!strcmp(name, "none")) {
+            snapshot = BLOBSTORE_SNAPSHOT_NONE;
+        } else if (!strcmp(name, "dm")) {
+            snapshot = BLOBSTORE_SNAPSHOT_DM;
+        } else if (!strcmp(name, "thin")) {
+            snapshot = BLOBSTORE_SNAPSHOT_THIN;
+        } else {
+            printf("ERROR: unknown snapshot policy '%s'\n", name);
+            errors++;
+            continue;
+        }
+        for (int i = 0; i < counts_len; i++) {
+            errors += bench_store(out, base, snapshot, name, counts[i], threads, threads_len);
+        }
+    }
+
+    EUCA_FREE(snapshots);
+    if (out != stdout)
+        fclose(out);
+    return (errors);
+}
+#endif /* _BENCHMARK */
+
 //!
 //! Main entry point of the application
 //!
@@ -5752,6 +9692,13 @@ int main(int argc, char **argv)
     logfile(NULL, EUCA_LOG_TRACE, 4);
     blobstore_set_error_function(dummy_err_fn);
 
+#ifdef _BENCHMARK
+    logfile(NULL, EUCA_LOG_WARN, 4);   // tracing every call would dominate the timings
+    errors = do_benchmark(cwd, argc, argv);
+    blobstore_cleanup();
+    exit(errors);
+#endif /* _BENCHMARK */
+
     // if an argument is specified, it is treated as a blob name to create
     // this allows two simultaneous invocations of test_blobstore to compete
     // for the same blob so as to test the inter-process locks manually
@@ -168,6 +168,7 @@ typedef enum {
     BLOBSTORE_SNAPSHOT_ANY,            //!< on create, pick DM if possible; on open, allows for whatever policy is in effect
     BLOBSTORE_SNAPSHOT_NONE,           //!< snapshots are not used, disk copies are used for cloning
     BLOBSTORE_SNAPSHOT_DM,             //!< device mapper snapshots are used for cloning
+    BLOBSTORE_SNAPSHOT_THIN,           //!< snapshots are thin devices in a dm-thin pool of the store, with the source as external origin
 } blobstore_snapshot_t;
 
 typedef enum {
@@ -194,6 +195,24 @@ typedef enum {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Waits of this process on one kind of blobstore lock
+typedef struct _blobstore_lock_stats {
+    unsigned long long acquired;       //!< times the lock was obtained
+    unsigned long long timed_out;      //!< times the lock could not be obtained before the timeout
+    unsigned long long wait_usec;      //!< total time spent waiting, whether or not the lock was obtained
+    unsigned long long max_wait_usec;  //!< longest single wait
+} blobstore_lock_stats;
+
+//! Outcome of an fsck of a blobstore
+typedef struct _blobstore_fsck_stats {
+    unsigned int num_blobs;            //!< blobs examined
+    unsigned int num_skipped;          //!< of them, unchanged since the last check, whose devices were not checked again
+    unsigned int num_deleted;          //!< stale or inconsistent blobs deleted
+    unsigned int num_failed;           //!< stale or inconsistent blobs that could not be deleted
+    unsigned int num_unopenable;       //!< stale or inconsistent blobs that could not be opened, as they may be in use
+    long long usec;                    //!< time the check took
+} blobstore_fsck_stats;
+
 typedef struct _blobstore {
     char id[BLOBSTORE_MAX_PATH];       //!< ID of the blobstore, to handle directory moving
     char path[BLOBSTORE_MAX_PATH];     //!< full path to blobstore directory
@@ -202,6 +221,11 @@ typedef struct _blobstore {
     blobstore_snapshot_t snapshot_policy;
     blobstore_format_t format;
     int fd;                            //!< file descriptor of the blobstore metadata file
+    struct _blobstore_index *index;    //!< in-memory copy of the on-disk blob index, only valid while the store is locked
+    blobstore_lock_stats store_lock_stats;  //!< waits on the store lock, which guards space accounting and shared metadata
+    blobstore_lock_stats blob_lock_stats;   //!< waits on the locks of individual blobs
+    int sparse_accounting;             //!< count idle blobs by the blocks they take on disk (see blobstore_set_sparse_accounting())
+    time_t reclaim_mtime;              //!< blobs last modified before this have been reclaimed by blobstore_reclaim() already
 } blobstore;
 
 typedef struct _blockblob {
@@ -212,7 +236,7 @@ typedef struct _blockblob {
     char dm_name[MAX_DM_NAME];         //!< name of the main device mapper device if this is a clone
     unsigned long long size_bytes;     //!< size of the blob in bytes
     unsigned long long blocks_allocated;    //!< actual number of blocks on disk taken by the blob
-    blobstore_snapshot_t snapshot_type; //!< ANY = not initialized/known, NONE = not a snapshot, DM = DM-based snapshot
+    blobstore_snapshot_t snapshot_type; //!< ANY = not initialized/known, NONE = not a snapshot, DM = DM-based snapshot, thin ones included
     unsigned int in_use;               //!< flags showing how the blockblob is being used (OPENED, LOCKED, LINKED)
     unsigned char is_hollow;           //!< blockblob is 'hollow' - its size doesn't count toward the limit
     time_t last_accessed;              //!< timestamp of last access
@@ -262,6 +286,10 @@ typedef struct _blobstore_meta {
     unsigned long long fs_bytes_available;  //!< bytes available on the file system that blobstore resides on
     int fs_id;                         //!< hash of file system ID, as returned by statfs()
     unsigned int num_blobs;            //!< count of blobs in the blobstore
+    unsigned long long pool_blocks_size;    //!< size of the thin pool of the blobstore, in blocks, or 0 if it has none
+    unsigned long long pool_blocks_used;    //!< blocks of the thin pool that have been provisioned to thin snapshots
+    blobstore_lock_stats store_lock_stats;  //!< waits of this process on the store lock, through this handle
+    blobstore_lock_stats blob_lock_stats;   //!< waits of this process on blob locks, through this handle
     blobstore_revocation_t revocation_policy;
     blobstore_snapshot_t snapshot_policy;
     blobstore_format_t format;
@@ -308,9 +336,15 @@ int blobstore_get_error(void);
 ssize_t get_line_desc(char **ppLine, size_t * n, int fd);
 int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path);
 int blobstore_stat(blobstore * bs, blobstore_meta * meta);
+long long blobstore_evict(blobstore * bs, unsigned long long high_blocks, unsigned long long low_blocks);
+void blobstore_set_sparse_accounting(blobstore * bs, int enabled);
+long long blobstore_reclaim(blobstore * bs);
 int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb));
+int blobstore_fsck_pass(blobstore * bs, int (*examiner) (const blockblob * bb), int check_devices, blobstore_fsck_stats * stats);
 int blobstore_search(blobstore * bs, const char *regex, blockblob_meta ** results);
 int blobstore_delete_regex(blobstore * bs, const char *regex);
+int blobstore_get_content_key(blobstore * bs, const char *key, char *bb_id, int bb_id_size);
+int blobstore_put_content_key(blobstore * bs, const char *key, const char *bb_id);
 //! @}
 
 //! @{
@@ -320,10 +354,12 @@ int blockblob_close(blockblob * bb);
 int blockblob_delete(blockblob * bb, long long timeout_usec, char do_force);
 int blockblob_copy(blockblob * src_bb, unsigned long long src_offset_bytes, blockblob * dst_bb, unsigned long long dst_offset_bytes, unsigned long long len_bytes); //
 int blockblob_clone(blockblob * bb, const blockmap * map, unsigned int map_size);
+int blockblob_add_backing(blockblob * bb, blockblob * backing);
 const char *blockblob_get_dev(blockblob * bb);
 const char *blockblob_get_file(blockblob * bb);
 blobstore *blockblob_get_blobstore(blockblob * bb);
 int blockblob_get_dir(blockblob * bb, char *buf, int buflen);
+int blockblob_get_sig(blockblob * bb, char *buf, int buflen);
 unsigned long long blockblob_get_size_blocks(blockblob * bb);
 unsigned long long blockblob_get_size_bytes(blockblob * bb);
 int blockblob_sync(const char *dev_path, const blockblob * bb);
@@ -86,6 +86,20 @@
 #include <sys/stat.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>                  // BLKZEROOUT, BLKGETSIZE64
+#include <linux/loop.h>
+
+#include <eucalyptus-config.h>         // HAVE_LINUX_IO_URING_H
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#define DISKUTIL_IO_URING                        //!< the I/O engine is built on io_uring, otherwise diskutil_io_open() always fails
+#endif /* HAVE_LINUX_IO_URING_H && __NR_io_uring_setup */
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl
@@ -101,8 +115,18 @@
 \*----------------------------------------------------------------------------*/
 
 #define LOOP_RETRIES                             9
-#define OUTPUT_ALLOC_CHUNK 1024
+#define LOOP_CONTROL_DEV                         "/dev/loop-control"
+#define LOOP_POOL_SIZE                           16 //!< loopback devices created up front when they can be attached directly
+#define LOOP_GRAB_RETRIES                        32 //!< attempts at attaching a free device that another process takes first
 #define MAX_OUTPUT_BYTES 1024*1024
+#define DISKUTIL_COPY_BUF_BYTES                  (1024 * 1024)  //!< size of the buffer the in-process copy goes through when the kernel cannot copy for it
+#define DISKUTIL_COPY_PROGRESS_BYTES             (1024LL * 1024 * 1024) //!< how often the in-process copy logs its progress
+#define DISKUTIL_PUNCH_MIN_BYTES                 (64 * 1024)    //!< smallest run of zeroes worth punching out of a file, must divide DISKUTIL_COPY_BUF_BYTES
+#define DISKUTIL_IO_DEPTH                        32     //!< buffers an I/O engine keeps in flight
+#define DISKUTIL_IO_SLOT_BYTES                   (128 * 1024)   //!< size of each of them, all of them fit under the usual memlock limit
+#define DISKUTIL_IO_ALIGN                        4096   //!< alignment of the buffers, enough for O_DIRECT files
+#define DISKUTIL_IO_POLICIES                     8      //!< directories that can be given an I/O policy
+#define DISKUTIL_DROP_BEHIND_BYTES               (64LL * 1024 * 1024)   //!< how far behind the writes of a copy its pages are dropped from the cache
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -138,12 +162,74 @@ enum {
     LASTHELPER
 };
 
+#ifdef DISKUTIL_IO_URING
+//! What a buffer of an I/O engine is doing
+enum {
+    DISKUTIL_IO_IDLE = 0,              //!< free
+    DISKUTIL_IO_FILL,                  //!< gathering writes, see diskutil_io_write()
+    DISKUTIL_IO_READ,                  //!< being read from the source, to be written once full
+    DISKUTIL_IO_WRITE,                 //!< being written to the destination
+};
+#endif /* DISKUTIL_IO_URING */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! The I/O policy of the files under a directory, see diskutil_set_io_policy()
+typedef struct io_policy_entry_t {
+    char dir[EUCA_MAX_PATH];           //!< the directory, without a trailing '/'
+    size_t dir_len;                    //!< strlen() of dir
+    int policy;                        //!< DISKUTIL_IO_POLICY_* flags
+} io_policy_entry;
+
+#ifdef DISKUTIL_IO_URING
+//! One of the buffers of an I/O engine, with the operation it is going through
+typedef struct diskutil_io_slot_t {
+    char *buf;                         //!< DISKUTIL_IO_SLOT_BYTES bytes, registered with the ring if io->fixed_bufs
+    int state;                         //!< DISKUTIL_IO_IDLE, DISKUTIL_IO_FILL, DISKUTIL_IO_READ or DISKUTIL_IO_WRITE
+    int pattern;                       //!< 1 + the byte the whole buffer is filled with, or 0 if it holds data
+    off_t ioff;                        //!< where in the source the buffer is read from
+    off_t ooff;                        //!< where in the destination the buffer is written to
+    size_t len;                        //!< bytes of the buffer in use
+    size_t done;                       //!< bytes of them read or written so far
+    struct iovec iov;                  //!< what the operation covers, when the buffers are not registered
+} diskutil_io_slot;
+
+//! An io_uring ring between two files, with its buffers
+struct diskutil_io_t {
+    int ring_fd;                       //!< the ring
+    int ifd;                           //!< the file to read from, or -1
+    int ofd;                           //!< the file to write to
+    int ifd_idx;                       //!< index of ifd among the registered files
+    int ofd_idx;                       //!< index of ofd among the registered files
+    boolean fixed_files;               //!< set if the files are registered with the ring
+    boolean fixed_bufs;                //!< set if the buffers are registered with the ring
+    int error;                         //!< errno of the first operation that failed, none starts after it
+    unsigned queued;                   //!< operations queued but not submitted yet
+    int inflight;                      //!< slots going through a read or a write
+    void *sq_map;                      //!< the submission ring
+    size_t sq_map_len;
+    void *cq_map;                      //!< the completion ring
+    size_t cq_map_len;
+    struct io_uring_sqe *sqes;         //!< the submission queue entries
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    char *pool;                        //!< the memory of all the buffers
+    diskutil_io_slot *filling;         //!< the slot diskutil_io_write() is gathering writes in, if any
+    diskutil_io_slot slots[DISKUTIL_IO_DEPTH];
+};
+#endif /* DISKUTIL_IO_URING */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -190,10 +276,13 @@ static char *helpers_path[LASTHELPER] = { NULL };
 static char stage_files_dir[EUCA_MAX_PATH] = "";
 static int initialized = 0;
 static sem *loop_sem = NULL;           //!< semaphore held while attaching/detaching loopback devices
+static boolean loop_direct = FALSE;    //!< set when this process may attach loopback devices itself, without rootwrap and losetup
 static unsigned char grub_version = 0;
 static char euca_home_path[EUCA_MAX_PATH] = "";
 static char cloud_cert_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/cloud-cert.pem";
 static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.pem";
+static io_policy_entry io_policies[DISKUTIL_IO_POLICIES] = { {{0}} };  //!< set up before the threads that do I/O start, read-only after that
+static int io_policies_count = 0;
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -202,9 +291,28 @@ static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.
 \*----------------------------------------------------------------------------*/
 
 static int try_stage_dir(const char *dir);
+#ifdef DISKUTIL_IO_URING
+static int diskutil_io_enter(diskutil_io * io, unsigned wait);
+static void diskutil_io_prep(diskutil_io * io, diskutil_io_slot * slot);
+static void diskutil_io_complete(diskutil_io * io, diskutil_io_slot * slot, int res);
+static int diskutil_io_reap(diskutil_io * io, unsigned wait);
+static diskutil_io_slot *diskutil_io_slot_get(diskutil_io * io);
+static void diskutil_io_start(diskutil_io * io, diskutil_io_slot * slot, int state);
+static int diskutil_io_drain(diskutil_io * io);
+#endif /* DISKUTIL_IO_URING */
+static int diskutil_copy_data(int ifd, int ofd, off_t ioff, off_t ooff, long long len, char *buf, boolean * use_cfr, diskutil_io * io);
+static int diskutil_zero_range(int ofd, off_t ooff, long long len, boolean regular, char *buf, diskutil_io * io);
+static int diskutil_zero_write(int fd, const char *path, off_t size);
+static boolean diskutil_set_direct(int fd, const char *path, off_t off, long long len);
+static int diskutil_zero_fast(const char *path, const long long sectors, boolean zero_fill);
 static char *pruntf(boolean log_error, char *format, ...)
 _attribute_wur_ _attribute_format_(2, 3);
 static char *execlp_output(boolean log_error, ...);
+static void loop_pool_init(void);
+static int loop_configure(int lfd, int ffd, const char *path, const long long offset, boolean read_only);
+static int loop_attach_direct(const char *path, const long long offset, char *lodev, int lodev_size);
+static int loop_detach_direct(const char *lodev);
+static int loop_backing_file(const char *lodev, char *path, int path_size);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -343,6 +451,8 @@ int diskutil_init(boolean require_grub)
 
         if ((initialized < 1) && (loop_sem == NULL))
             loop_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+        if (initialized < 1)
+            loop_pool_init();
         initialized = 1 + require_grub;
     }
 
@@ -364,7 +474,11 @@ int diskutil_cleanup(void)
 }
 
 //!
-//!
+//! Creates a disk file of 'sectors' sectors (or zeroes that much of a block device).
+//! With 'zero_fill' the whole of it reads as zeros and, for a file, its space is
+//! allocated; otherwise only the last sector is. This is done in place, with
+//! ftruncate, fallocate or BLKZEROOUT, and dd only writes the zeros out when the
+//! file system or the device cannot do better or the file is beyond our reach.
 //!
 //! @param[in] path
 //! @param[in] sectors
@@ -385,6 +499,9 @@ int diskutil_ddzero(const char *path, const long long sectors, boolean zero_fill
     long long seek = sectors - 1;
 
     if (path) {
+        if (diskutil_zero_fast(path, sectors, zero_fill) == EUCA_OK)
+            return (EUCA_OK);
+
         if (zero_fill) {
             count = sectors;
             seek = 0;
@@ -449,66 +566,1244 @@ int diskutil_dd(const char *in, const char *out, const int bs, const long long c
             return (EUCA_ERROR);
         }
 
-        EUCA_FREE(output);
-        return (EUCA_OK);
-    }
+        EUCA_FREE(output);
+        return (EUCA_OK);
+    }
+
+    LOGWARN("bad params: in=%s, out=%s\n", SP(in), SP(out));
+    return (EUCA_INVALID_ERROR);
+}
+
+//!
+//!
+//!
+//! @param[in] in
+//! @param[in] out
+//! @param[in] bs
+//! @param[in] count
+//! @param[in] seek
+//! @param[in] skip
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_ERROR: if we fail to copy the disk file
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!
+//! @pre Both in and out paramters must not be NULL.
+//!
+//! @post On success the data from 'in' has been copied in 'out'.
+//!
+int diskutil_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip)
+{
+    char *output = NULL;
+
+    if (in && out) {
+        LOGINFO("copying data from '%s'\n", in);
+        LOGINFO("               to '%s'\n", out);
+        LOGINFO("               of %lld blocks (bs=%d), seeking %lld, skipping %lld\n", count, bs, seek, skip);
+
+        char if_str[EUCA_MAX_PATH] = "";
+        snprintf(if_str, sizeof(if_str), "if=%s", in);
+        char of_str[EUCA_MAX_PATH] = "";
+        snprintf(of_str, sizeof(of_str), "of=%s", out);
+        char bs_str[64];
+        snprintf(bs_str, sizeof(bs_str), "bs=%d", bs);
+        char count_str[64];
+        snprintf(count_str, sizeof(count_str), "count=%lld", count);
+        char seek_str[64];
+        snprintf(seek_str, sizeof(seek_str), "seek=%lld", seek);
+        char skip_str[64];
+        snprintf(skip_str, sizeof(skip_str), "skip=%lld", skip);
+        output = execlp_output(TRUE, helpers_path[ROOTWRAP], helpers_path[DD], if_str, of_str, bs_str, count_str, seek_str, skip_str, "conv=notrunc,fsync", NULL);
+        if (!output) {
+            LOGERROR("cannot copy '%s'\n", in);
+            LOGERROR("                to '%s'\n", out);
+            return (EUCA_ERROR);
+        }
+
+        EUCA_FREE(output);
+        return (EUCA_OK);
+    }
+
+    LOGWARN("bad params: in=%s, out=%s\n", SP(in), SP(out));
+    return (EUCA_INVALID_ERROR);
+}
+
+#ifdef DISKUTIL_IO_URING
+
+//!
+//! Enters the ring of an I/O engine, submitting the operations queued since the last call
+//!
+//! @param[in] io the engine
+//! @param[in] wait number of completions to wait for
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the kernel refused the operations
+//!
+static int diskutil_io_enter(diskutil_io * io, unsigned wait)
+{
+    int rc = 0;
+
+    while (io->queued || wait) {
+        rc = syscall(__NR_io_uring_enter, io->ring_fd, io->queued, wait, (wait ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+        if (rc < 0) {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+                // completions have to be reaped before anything more gets in
+                if (wait || (*io->cq_tail != *io->cq_head))
+                    return (EUCA_OK);
+                continue;
+            }
+            return (EUCA_ERROR);
+        }
+        io->queued -= ((rc < io->queued) ? rc : io->queued);
+        wait = 0;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Queues the next read or write of a slot of an I/O engine, picking up where the
+//! previous one of the slot left off
+//!
+//! @param[in] io the engine
+//! @param[in] slot the slot
+//!
+static void diskutil_io_prep(diskutil_io * io, diskutil_io_slot * slot)
+{
+    unsigned tail = *io->sq_tail;
+    unsigned idx = (tail & *io->sq_mask);
+    boolean reading = (slot->state == DISKUTIL_IO_READ);
+    struct io_uring_sqe *sqe = &(io->sqes[idx]);
+
+    bzero(sqe, sizeof(struct io_uring_sqe));
+    if (io->fixed_files) {
+        sqe->fd = (reading ? io->ifd_idx : io->ofd_idx);
+        sqe->flags = IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = (reading ? io->ifd : io->ofd);
+    }
+    sqe->off = ((reading ? slot->ioff : slot->ooff) + slot->done);
+    sqe->user_data = (slot - io->slots);
+    if (io->fixed_bufs) {
+        sqe->opcode = (reading ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED);
+        sqe->addr = (unsigned long)(slot->buf + slot->done);
+        sqe->len = (slot->len - slot->done);
+        sqe->buf_index = (slot - io->slots);
+    } else {
+        slot->iov.iov_base = (slot->buf + slot->done);
+        slot->iov.iov_len = (slot->len - slot->done);
+        sqe->opcode = (reading ? IORING_OP_READV : IORING_OP_WRITEV);
+        sqe->addr = (unsigned long)&(slot->iov);
+        sqe->len = 1;
+    }
+
+    io->sq_array[idx] = idx;
+    __atomic_store_n(io->sq_tail, (tail + 1), __ATOMIC_RELEASE);
+    io->queued++;
+}
+
+//!
+//! Moves a slot of an I/O engine along once an operation of it completes: a short read
+//! or write is continued, a completed read is written out and a completed write frees
+//! the slot. The first failure is kept in the engine and lets no new operation start.
+//!
+//! @param[in] io the engine
+//! @param[in] slot the slot
+//! @param[in] res the result of the operation
+//!
+static void diskutil_io_complete(diskutil_io * io, diskutil_io_slot * slot, int res)
+{
+    if ((res == -EINTR) || (res == -EAGAIN)) {
+        res = 0;
+    } else if (res <= 0) {
+        // a source that ends early is as much a failure as an error
+        if (!io->error)
+            io->error = ((res < 0) ? -res : EIO);
+    } else {
+        slot->done += res;
+    }
+
+    if (io->error) {
+        slot->state = DISKUTIL_IO_IDLE;
+        io->inflight--;
+        return;
+    }
+
+    if (slot->done < slot->len) {
+        diskutil_io_prep(io, slot);
+    } else if (slot->state == DISKUTIL_IO_READ) {
+        slot->state = DISKUTIL_IO_WRITE;
+        slot->done = 0;
+        diskutil_io_prep(io, slot);
+    } else {
+        slot->state = DISKUTIL_IO_IDLE;
+        io->inflight--;
+    }
+}
+
+//!
+//! Submits what is queued in an I/O engine, waits for at least 'wait' operations to complete
+//! and handles all the completions there are
+//!
+//! @param[in] io the engine
+//! @param[in] wait number of completions to wait for
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the ring itself failed
+//!
+static int diskutil_io_reap(diskutil_io * io, unsigned wait)
+{
+    unsigned head = 0;
+    struct io_uring_cqe *cqe = NULL;
+
+    if (diskutil_io_enter(io, wait) != EUCA_OK) {
+        if (!io->error)
+            io->error = errno;
+        return (EUCA_ERROR);
+    }
+
+    head = *io->cq_head;
+    while (head != __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &(io->cqes[head & *io->cq_mask]);
+        diskutil_io_complete(io, &(io->slots[cqe->user_data]), cqe->res);
+        head++;
+        __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Finds a slot of an I/O engine that is not in use, waiting for one to free up if needed
+//!
+//! @param[in] io the engine
+//!
+//! @return a pointer to the slot or NULL if the engine has failed
+//!
+static diskutil_io_slot *diskutil_io_slot_get(diskutil_io * io)
+{
+    int i = 0;
+
+    while (!io->error) {
+        for (i = 0; i < DISKUTIL_IO_DEPTH; i++) {
+            if (io->slots[i].state == DISKUTIL_IO_IDLE) {
+                io->slots[i].done = 0;
+                io->slots[i].len = 0;
+                return (&(io->slots[i]));
+            }
+        }
+        if (diskutil_io_reap(io, 1) != EUCA_OK)
+            break;
+    }
+    return (NULL);
+}
+
+//!
+//! Starts a slot of an I/O engine on its first operation
+//!
+//! @param[in] io the engine
+//! @param[in] slot the slot
+//! @param[in] state DISKUTIL_IO_READ to read and then write the slot, or DISKUTIL_IO_WRITE to only write it
+//!
+static void diskutil_io_start(diskutil_io * io, diskutil_io_slot * slot, int state)
+{
+    slot->state = state;
+    slot->done = 0;
+    io->inflight++;
+    diskutil_io_prep(io, slot);
+
+    // submit as soon as the ring is full, and keep it full from then on
+    if (io->queued >= DISKUTIL_IO_DEPTH)
+        diskutil_io_reap(io, 0);
+}
+
+//!
+//! Waits for all the operations of an I/O engine to complete
+//!
+//! @param[in] io the engine
+//!
+//! @return EUCA_OK if all of them, and all since the engine was opened, succeeded or
+//!         EUCA_ERROR, with errno set, otherwise
+//!
+static int diskutil_io_drain(diskutil_io * io)
+{
+    while (io->inflight > 0) {
+        if (diskutil_io_reap(io, 1) != EUCA_OK)
+            break;
+    }
+
+    if (io->error) {
+        errno = io->error;
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+#endif /* DISKUTIL_IO_URING */
+
+//!
+//! Opens an io_uring I/O engine between two open files. The engine keeps DISKUTIL_IO_DEPTH
+//! buffers of DISKUTIL_IO_SLOT_BYTES bytes in flight, reading the source into one while the
+//! others are written to the destination, so a single thread keeps a fast device busy. The
+//! buffers and the files are registered with the kernel when it lets us, which saves it from
+//! mapping them again for every operation.
+//!
+//! @param[in] ifd the file the engine reads from, or -1 if it only writes
+//! @param[in] ofd the file the engine writes to
+//!
+//! @return a pointer to the engine, to be released with diskutil_io_close(), or NULL if the
+//!         kernel has no io_uring (or this build does not use it) and the caller is to do
+//!         its own I/O
+//!
+diskutil_io *diskutil_io_open(int ifd, int ofd)
+{
+#ifdef DISKUTIL_IO_URING
+    int i = 0;
+    int nfds = 0;
+    int fds[2] = { -1, -1 };
+    size_t sq_len = 0;
+    size_t cq_len = 0;
+    diskutil_io *io = NULL;
+    struct iovec iovs[DISKUTIL_IO_DEPTH] = { {0} };
+    struct io_uring_params params = { 0 };
+
+    if (ofd < 0)
+        return (NULL);
+
+    if ((io = EUCA_ZALLOC(1, sizeof(diskutil_io))) == NULL)
+        return (NULL);
+
+    io->ifd = ifd;
+    io->ofd = ofd;
+    io->sq_map = io->cq_map = io->sqes = MAP_FAILED;
+    if ((io->ring_fd = syscall(__NR_io_uring_setup, DISKUTIL_IO_DEPTH, &params)) < 0) {
+        LOGTRACE("io_uring is not available (%s)\n", strerror(errno));
+        EUCA_FREE(io);
+        return (NULL);
+    }
+
+    sq_len = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+    cq_len = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+    io->sq_map_len = sq_len;
+    io->cq_map_len = cq_len;
+    io->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sq_map = mmap(NULL, sq_len, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE), io->ring_fd, IORING_OFF_SQ_RING);
+    io->cq_map = mmap(NULL, cq_len, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE), io->ring_fd, IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, io->sqes_len, (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_POPULATE), io->ring_fd, IORING_OFF_SQES);
+    if ((io->sq_map == MAP_FAILED) || (io->cq_map == MAP_FAILED) || (io->sqes == MAP_FAILED) || (params.sq_entries < DISKUTIL_IO_DEPTH)
+        || posix_memalign((void **)&(io->pool), DISKUTIL_IO_ALIGN, (DISKUTIL_IO_DEPTH * DISKUTIL_IO_SLOT_BYTES))) {
+        LOGWARN("failed to set up io_uring (%s)\n", strerror(errno));
+        io->pool = NULL;
+        diskutil_io_close(&io);
+        return (NULL);
+    }
+
+    io->sq_head = (unsigned *)((char *)io->sq_map + params.sq_off.head);
+    io->sq_tail = (unsigned *)((char *)io->sq_map + params.sq_off.tail);
+    io->sq_mask = (unsigned *)((char *)io->sq_map + params.sq_off.ring_mask);
+    io->sq_array = (unsigned *)((char *)io->sq_map + params.sq_off.array);
+    io->cq_head = (unsigned *)((char *)io->cq_map + params.cq_off.head);
+    io->cq_tail = (unsigned *)((char *)io->cq_map + params.cq_off.tail);
+    io->cq_mask = (unsigned *)((char *)io->cq_map + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)((char *)io->cq_map + params.cq_off.cqes);
+
+    for (i = 0; i < DISKUTIL_IO_DEPTH; i++) {
+        io->slots[i].buf = io->pool + (i * DISKUTIL_IO_SLOT_BYTES);
+        iovs[i].iov_base = io->slots[i].buf;
+        iovs[i].iov_len = DISKUTIL_IO_SLOT_BYTES;
+    }
+
+    // registering pins the buffers, which the memlock limit may not allow
+    if (syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_BUFFERS, iovs, DISKUTIL_IO_DEPTH) == 0) {
+        io->fixed_bufs = TRUE;
+    } else {
+        LOGTRACE("cannot register io_uring buffers (%s), using vectored I/O\n", strerror(errno));
+    }
+
+    if (ifd >= 0) {
+        io->ifd_idx = nfds;
+        fds[nfds++] = ifd;
+    }
+    io->ofd_idx = nfds;
+    fds[nfds++] = ofd;
+    if (syscall(__NR_io_uring_register, io->ring_fd, IORING_REGISTER_FILES, fds, nfds) == 0)
+        io->fixed_files = TRUE;
+
+    return (io);
+#else /* DISKUTIL_IO_URING */
+    return (NULL);
+#endif /* DISKUTIL_IO_URING */
+}
+
+//!
+//! Copies a byte range between the files of an I/O engine, with up to DISKUTIL_IO_DEPTH
+//! reads and writes in flight at once
+//!
+//! @param[in] io the engine
+//! @param[in] ioff where in the source to start
+//! @param[in] ooff where in the destination to start
+//! @param[in] len number of bytes to copy
+//!
+//! @return EUCA_OK on success or EUCA_ERROR, with errno set, if the copy failed or the source ended early
+//!
+int diskutil_io_copy(diskutil_io * io, off_t ioff, off_t ooff, long long len)
+{
+#ifdef DISKUTIL_IO_URING
+    diskutil_io_slot *slot = NULL;
+
+    if (!io || (io->ifd < 0)) {
+        errno = EINVAL;
+        return (EUCA_ERROR);
+    }
+
+    while ((len > 0) && ((slot = diskutil_io_slot_get(io)) != NULL)) {
+        slot->pattern = 0;
+        slot->ioff = ioff;
+        slot->ooff = ooff;
+        slot->len = ((len < DISKUTIL_IO_SLOT_BYTES) ? len : DISKUTIL_IO_SLOT_BYTES);
+        ioff += slot->len;
+        ooff += slot->len;
+        len -= slot->len;
+        diskutil_io_start(io, slot, DISKUTIL_IO_READ);
+    }
+    return (diskutil_io_drain(io));
+#else /* DISKUTIL_IO_URING */
+    errno = ENOSYS;
+    return (EUCA_ERROR);
+#endif /* DISKUTIL_IO_URING */
+}
+
+//!
+//! Fills a byte range of the destination of an I/O engine with copies of one byte
+//!
+//! @param[in] io the engine
+//! @param[in] ooff where to start
+//! @param[in] len number of bytes to fill
+//! @param[in] c the byte to fill with
+//!
+//! @return EUCA_OK on success or EUCA_ERROR, with errno set, on failure
+//!
+int diskutil_io_fill(diskutil_io * io, off_t ooff, long long len, int c)
+{
+#ifdef DISKUTIL_IO_URING
+    diskutil_io_slot *slot = NULL;
+
+    if (!io) {
+        errno = EINVAL;
+        return (EUCA_ERROR);
+    }
+
+    while ((len > 0) && ((slot = diskutil_io_slot_get(io)) != NULL)) {
+        // the slots are only ever written from here on, so each one is set once
+        if (slot->pattern != (c & 0xff) + 1) {
+            memset(slot->buf, c, DISKUTIL_IO_SLOT_BYTES);
+            slot->pattern = (c & 0xff) + 1;
+        }
+        slot->ooff = ooff;
+        slot->len = ((len < DISKUTIL_IO_SLOT_BYTES) ? len : DISKUTIL_IO_SLOT_BYTES);
+        ooff += slot->len;
+        len -= slot->len;
+        diskutil_io_start(io, slot, DISKUTIL_IO_WRITE);
+    }
+    return (diskutil_io_drain(io));
+#else /* DISKUTIL_IO_URING */
+    errno = ENOSYS;
+    return (EUCA_ERROR);
+#endif /* DISKUTIL_IO_URING */
+}
+
+//!
+//! Writes a buffer to the destination of an I/O engine without waiting for the write to
+//! complete. Writes that follow each other in the file are gathered into full slots before
+//! they are submitted, so a stream of small writes still reaches the device in large ones.
+//!
+//! @param[in] io the engine
+//! @param[in] buf the data to write, which the caller may reuse as soon as this returns
+//! @param[in] len number of bytes to write
+//! @param[in] off where in the destination to write them
+//!
+//! @return EUCA_OK on success or EUCA_ERROR, with errno set, if this or an earlier
+//!         write failed
+//!
+//! @see diskutil_io_flush() to wait for the writes to complete
+//!
+int diskutil_io_write(diskutil_io * io, const char *buf, size_t len, off_t off)
+{
+#ifdef DISKUTIL_IO_URING
+    size_t chunk = 0;
+    diskutil_io_slot *slot = NULL;
+
+    if (!io || (!buf && len)) {
+        errno = EINVAL;
+        return (EUCA_ERROR);
+    }
+
+    while (len > 0) {
+        slot = io->filling;
+        if (slot && ((slot->ooff + slot->len) != off)) {
+            // not where the last write ended, send what was gathered on its way
+            io->filling = NULL;
+            diskutil_io_start(io, slot, DISKUTIL_IO_WRITE);
+            slot = NULL;
+        }
+        if (!slot) {
+            if ((slot = diskutil_io_slot_get(io)) == NULL)
+                break;
+            slot->state = DISKUTIL_IO_FILL;
+            slot->pattern = 0;
+            slot->ooff = off;
+            io->filling = slot;
+        }
+
+        chunk = DISKUTIL_IO_SLOT_BYTES - slot->len;
+        chunk = ((len < chunk) ? len : chunk);
+        memcpy(slot->buf + slot->len, buf, chunk);
+        slot->len += chunk;
+        buf += chunk;
+        off += chunk;
+        len -= chunk;
+
+        if (slot->len == DISKUTIL_IO_SLOT_BYTES) {
+            io->filling = NULL;
+            diskutil_io_start(io, slot, DISKUTIL_IO_WRITE);
+        }
+    }
+
+    if (io->error) {
+        errno = io->error;
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+#else /* DISKUTIL_IO_URING */
+    errno = ENOSYS;
+    return (EUCA_ERROR);
+#endif /* DISKUTIL_IO_URING */
+}
+
+//!
+//! Submits the writes an I/O engine has gathered and waits for all of its operations to complete
+//!
+//! @param[in] io the engine
+//!
+//! @return EUCA_OK if all the writes since the engine was opened succeeded or EUCA_ERROR,
+//!         with errno set, otherwise
+//!
+int diskutil_io_flush(diskutil_io * io)
+{
+#ifdef DISKUTIL_IO_URING
+    diskutil_io_slot *slot = NULL;
+
+    if (!io) {
+        errno = EINVAL;
+        return (EUCA_ERROR);
+    }
+
+    if ((slot = io->filling) != NULL) {
+        io->filling = NULL;
+        if (io->error || (slot->len == 0)) {
+            slot->state = DISKUTIL_IO_IDLE;
+        } else {
+            diskutil_io_start(io, slot, DISKUTIL_IO_WRITE);
+        }
+    }
+    return (diskutil_io_drain(io));
+#else /* DISKUTIL_IO_URING */
+    errno = ENOSYS;
+    return (EUCA_ERROR);
+#endif /* DISKUTIL_IO_URING */
+}
+
+//!
+//! Releases an I/O engine, after waiting for the operations it still has in flight.
+//! Writes it has gathered but not submitted are dropped, diskutil_io_flush() them first.
+//!
+//! @param[in,out] pio a pointer to the engine pointer, set to NULL
+//!
+void diskutil_io_close(diskutil_io ** pio)
+{
+#ifdef DISKUTIL_IO_URING
+    diskutil_io *io = NULL;
+
+    if (!pio || ((io = *pio) == NULL))
+        return;
+
+    // the kernel may still be reading or writing the buffers
+    while ((io->inflight > 0) && (diskutil_io_reap(io, 1) == EUCA_OK)) ;
+
+    if (io->sqes != MAP_FAILED)
+        munmap(io->sqes, io->sqes_len);
+    if (io->cq_map != MAP_FAILED)
+        munmap(io->cq_map, io->cq_map_len);
+    if (io->sq_map != MAP_FAILED)
+        munmap(io->sq_map, io->sq_map_len);
+    close(io->ring_fd);
+    if (io->inflight == 0)
+        EUCA_FREE(io->pool);
+    EUCA_FREE(*pio);
+#endif /* DISKUTIL_IO_URING */
+}
+
+//!
+//! Copies a byte range between two open files, through copy_file_range() while the kernel
+//! and the file systems allow it and through buffers after that: those of the I/O engine for
+//! more than DISKUTIL_COPY_BUF_BYTES bytes, when there is one, or 'buf' otherwise
+//!
+//! @param[in]     ifd the file to copy from
+//! @param[in]     ofd the file to copy to
+//! @param[in]     ioff where in the source to start
+//! @param[in]     ooff where in the destination to start
+//! @param[in]     len number of bytes to copy
+//! @param[in]     buf buffer of DISKUTIL_COPY_BUF_BYTES bytes
+//! @param[in,out] use_cfr whether copy_file_range() may be tried, cleared once it is found not to work
+//! @param[in]     io an I/O engine between ifd and ofd, or NULL
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the copy failed or the source ended early
+//!
+static int diskutil_copy_data(int ifd, int ofd, off_t ioff, off_t ooff, long long len, char *buf, boolean * use_cfr, diskutil_io * io)
+{
+    ssize_t got = 0;
+    ssize_t put = 0;
+    ssize_t chunk = 0;
+
+    while (len > 0) {
+#ifdef SYS_copy_file_range
+        if (*use_cfr) {
+            loff_t cfr_ioff = ioff, cfr_ooff = ooff;
+            got = syscall(SYS_copy_file_range, ifd, &cfr_ioff, ofd, &cfr_ooff, (size_t) ((len < DISKUTIL_COPY_BUF_BYTES * 64LL) ? len : DISKUTIL_COPY_BUF_BYTES * 64LL), 0);
+            if (got > 0) {
+                ioff += got;
+                ooff += got;
+                len -= got;
+                continue;
+            } else if (got == 0) {
+                return (EUCA_ERROR);
+            } else if ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP) || (errno == EBADF)) {
+                // not between these files, the buffered copy below takes over for good
+                *use_cfr = FALSE;
+            } else if (errno != EINTR) {
+                return (EUCA_ERROR);
+            }
+            continue;
+        }
+#endif /* SYS_copy_file_range */
+
+        if (io && (len > DISKUTIL_COPY_BUF_BYTES))
+            return (diskutil_io_copy(io, ioff, ooff, len));
+
+        chunk = ((len < DISKUTIL_COPY_BUF_BYTES) ? len : DISKUTIL_COPY_BUF_BYTES);
+        if ((got = pread(ifd, buf, chunk, ioff)) <= 0) {
+            if ((got < 0) && (errno == EINTR))
+                continue;
+            return (EUCA_ERROR);
+        }
+        for (chunk = 0; chunk < got; chunk += put) {
+            if ((put = pwrite(ofd, buf + chunk, got - chunk, ooff + chunk)) <= 0) {
+                if ((put < 0) && (errno == EINTR)) {
+                    put = 0;
+                    continue;
+                }
+                return (EUCA_ERROR);
+            }
+        }
+        ioff += got;
+        ooff += got;
+        len -= got;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Zeroes a byte range of an open file, by punching a hole in it when it is a regular file
+//! that allows it and by writing zeroes otherwise, through the I/O engine when there is one
+//! and the range is larger than DISKUTIL_COPY_BUF_BYTES
+//!
+//! @param[in] ofd the file
+//! @param[in] ooff where to start
+//! @param[in] len number of bytes to zero
+//! @param[in] regular TRUE if the file is a regular file
+//! @param[in] buf zeroed buffer of DISKUTIL_COPY_BUF_BYTES bytes
+//! @param[in] io an I/O engine writing to ofd, or NULL
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int diskutil_zero_range(int ofd, off_t ooff, long long len, boolean regular, char *buf, diskutil_io * io)
+{
+    ssize_t put = 0;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (regular && (fallocate(ofd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, ooff, len) == 0)) {
+        return (EUCA_OK);
+    }
+#endif /* FALLOC_FL_PUNCH_HOLE */
+
+    if (io && (len > DISKUTIL_COPY_BUF_BYTES))
+        return (diskutil_io_fill(io, ooff, len, 0));
+
+    while (len > 0) {
+        if ((put = pwrite(ofd, buf, ((len < DISKUTIL_COPY_BUF_BYTES) ? len : DISKUTIL_COPY_BUF_BYTES), ooff)) <= 0) {
+            if ((put < 0) && (errno == EINTR))
+                continue;
+            return (EUCA_ERROR);
+        }
+        ooff += put;
+        len -= put;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Writes zeros over the first 'size' bytes of an open file through an I/O engine, for
+//! the files and devices that cannot zero themselves
+//!
+//! @param[in] fd the file
+//! @param[in] path the path of the file, for its I/O policy
+//! @param[in] size number of bytes to zero
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if it is up to dd
+//!
+static int diskutil_zero_write(int fd, const char *path, off_t size)
+{
+    int ret = EUCA_ERROR;
+    boolean direct = FALSE;
+    diskutil_io *io = NULL;
+
+    if ((io = diskutil_io_open(-1, fd)) == NULL)
+        return (EUCA_ERROR);
+
+    direct = diskutil_set_direct(fd, path, 0, size);
+    if (diskutil_io_fill(io, 0, size, 0) == EUCA_OK) {
+        if (!direct && (diskutil_get_io_policy(path) & DISKUTIL_IO_POLICY_DONTNEED))
+            diskutil_drop_behind(fd, 0, 0);
+        ret = EUCA_OK;
+    } else {
+        LOGDEBUG("failed to write zeros (%s), will use dd\n", strerror(errno));
+    }
+    diskutil_io_close(&io);
+    return (ret);
+}
+
+//!
+//! The in-process part of diskutil_ddzero(), with the result dd would have given:
+//! a file is cut or extended to 'sectors' sectors, all of them zeros and allocated
+//! with 'zero_fill' or only the last one reset to zeros without it, while a block
+//! device gets its first 'sectors' sectors (or only the last one) zeroed.
+//!
+//! @param[in] path
+//! @param[in] sectors
+//! @param[in] zero_fill
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if it is up to dd
+//!
+static int diskutil_zero_fast(const char *path, const long long sectors, boolean zero_fill)
+{
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    u64 range[2] = { 0 };
+    u64 dev_bytes = 0;
+    off_t size = sectors * 512;
+    struct stat st = { 0 };
+    char zeros[512] = { 0 };
+
+    if (sectors < 1)
+        return (EUCA_ERROR);
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0666)) < 0) {
+        LOGDEBUG("cannot open %s (%s), will use dd\n", path, strerror(errno));
+        return (EUCA_ERROR);
+    }
+
+    if (fstat(fd, &st) < 0)
+        goto out;
+
+    if (S_ISBLK(st.st_mode)) {
+        if (!zero_fill) {
+            if (pwrite(fd, zeros, sizeof(zeros), size - sizeof(zeros)) == sizeof(zeros))
+                ret = EUCA_OK;
+            goto out;
+        }
+        // BLKZEROOUT lets the device unmap or write zeros itself; BLKDISCARD is not used
+        // since a discarded range is not guaranteed to read back as zeros
+        if ((ioctl(fd, BLKGETSIZE64, &dev_bytes) < 0) || (dev_bytes < size))
+            goto out;
+        range[0] = 0;
+        range[1] = size;
+        if (ioctl(fd, BLKZEROOUT, range) == 0) {
+            ret = EUCA_OK;
+        } else {
+            LOGDEBUG("cannot zero out %s (%s), writing zeros\n", path, strerror(errno));
+            ret = diskutil_zero_write(fd, path, size);
+        }
+        goto out;
+    }
+
+    if (!S_ISREG(st.st_mode))
+        goto out;
+
+    if (!zero_fill) {
+        // dd truncated the file at the last sector before writing it, so clear it the same way
+        if ((ftruncate(fd, size - sizeof(zeros)) == 0) && (ftruncate(fd, size) == 0))
+            ret = EUCA_OK;
+        goto out;
+    }
+    // the file is emptied first, so allocating it is enough for all of it to read as zeros
+    if (ftruncate(fd, 0) < 0)
+        goto out;
+    if (fallocate(fd, 0, 0, size) == 0) {
+        ret = EUCA_OK;
+    } else {
+        LOGDEBUG("cannot allocate %s (%s), writing zeros\n", path, strerror(errno));
+        ret = diskutil_zero_write(fd, path, size);
+    }
+
+out:
+    close(fd);
+    return (ret);
+}
+
+//!
+//! Parses an I/O policy from a configuration value, a list of the words "direct",
+//! "dontneed" and "sequential" (see the DISKUTIL_IO_POLICY_* flags) or "none"
+//!
+//! @param[in]  str the value, words separated by commas or spaces
+//! @param[out] policy set to the DISKUTIL_IO_POLICY_* flags of the words
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if a word is not one of these
+//!
+int diskutil_parse_io_policy(const char *str, int *policy)
+{
+    int len = 0;
+    const char *word = NULL;
+
+    if (!str || !policy)
+        return (EUCA_INVALID_ERROR);
+
+    *policy = 0;
+    for (word = str; *word; word += len) {
+        if ((len = strcspn(word, ", \t")) == 0) {
+            len = 1;
+            continue;
+        }
+
+        if ((len == 6) && !strncasecmp(word, "direct", len)) {
+            *policy |= DISKUTIL_IO_POLICY_DIRECT;
+        } else if ((len == 8) && !strncasecmp(word, "dontneed", len)) {
+            *policy |= DISKUTIL_IO_POLICY_DONTNEED;
+        } else if ((len == 10) && !strncasecmp(word, "sequential", len)) {
+            *policy |= DISKUTIL_IO_POLICY_SEQUENTIAL;
+        } else if ((len != 4) || strncasecmp(word, "none", len)) {
+            LOGERROR("unknown I/O policy '%.*s' in '%s'\n", len, word, str);
+            return (EUCA_INVALID_ERROR);
+        }
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Sets how the bulk I/O of diskutil (copies, zeroing) and of the downloads into the files
+//! under a directory treats the page cache. The policy of a directory can be changed by
+//! setting it again, but this is meant to be called during initialization, before any
+//! thread does I/O.
+//!
+//! @param[in] dir the directory
+//! @param[in] policy DISKUTIL_IO_POLICY_* flags, 0 for the default behavior
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if dir is NULL or too long
+//!         \li EUCA_OVERFLOW_ERROR: if DISKUTIL_IO_POLICIES directories already have a policy
+//!
+int diskutil_set_io_policy(const char *dir, int policy)
+{
+    int i = 0;
+    size_t len = 0;
+
+    if (!dir || ((len = strlen(dir)) >= EUCA_MAX_PATH))
+        return (EUCA_INVALID_ERROR);
+
+    while ((len > 1) && (dir[len - 1] == '/'))
+        len--;
+
+    for (i = 0; i < io_policies_count; i++) {
+        if ((io_policies[i].dir_len == len) && !strncmp(io_policies[i].dir, dir, len))
+            break;
+    }
+
+    if (i == DISKUTIL_IO_POLICIES)
+        return (EUCA_OVERFLOW_ERROR);
+
+    snprintf(io_policies[i].dir, sizeof(io_policies[i].dir), "%.*s", (int)len, dir);
+    io_policies[i].dir_len = len;
+    io_policies[i].policy = policy;
+    if (i == io_policies_count)
+        io_policies_count++;
+
+    LOGDEBUG("I/O policy of %s:%s%s%s%s\n", io_policies[i].dir, ((policy & DISKUTIL_IO_POLICY_DIRECT) ? " direct" : ""),
+             ((policy & DISKUTIL_IO_POLICY_DONTNEED) ? " dontneed" : ""), ((policy & DISKUTIL_IO_POLICY_SEQUENTIAL) ? " sequential" : ""), (policy ? "" : " none"));
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the I/O policy of a file, that of the deepest directory with a policy it is under
+//!
+//! @param[in] path the path of the file
+//!
+//! @return the DISKUTIL_IO_POLICY_* flags of the file, 0 if it is under no directory with a policy
+//!
+int diskutil_get_io_policy(const char *path)
+{
+    int i = 0;
+    int policy = 0;
+    size_t best = 0;
+
+    if (!path)
+        return (0);
+
+    for (i = 0; i < io_policies_count; i++) {
+        if ((io_policies[i].dir_len > best) && !strncmp(path, io_policies[i].dir, io_policies[i].dir_len)
+            && ((path[io_policies[i].dir_len] == '/') || (path[io_policies[i].dir_len] == '\0'))) {
+            best = io_policies[i].dir_len;
+            policy = io_policies[i].policy;
+        }
+    }
+    return (policy);
+}
+
+//!
+//! Drops what was written to a file from the page cache, so a large write does not push
+//! out the pages running instances work with. The writeback of everything written up to
+//! 'end' is started and all but the last 'lag' bytes of it are waited for and dropped,
+//! which lets a writer call this as it goes without waiting on the data it just wrote.
+//!
+//! @param[in] fd the file
+//! @param[in] end how far the file has been written, or 0 to write back and drop all of it
+//! @param[in] lag how much of what was just written to leave alone
+//!
+void diskutil_drop_behind(int fd, off_t end, off_t lag)
+{
+    if (end <= 0) {
+        if (fdatasync(fd) == 0)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        return;
+    }
+
+    sync_file_range(fd, 0, end, SYNC_FILE_RANGE_WRITE);
+    if (end > lag) {
+        // only pages that are clean can be dropped
+        sync_file_range(fd, 0, (end - lag), (SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER));
+        posix_fadvise(fd, 0, (end - lag), POSIX_FADV_DONTNEED);
+    }
+}
+
+//!
+//! Has the writes to a byte range of an open file bypass the page cache, if the I/O
+//! policy of the file asks for it and the range is aligned for O_DIRECT
+//!
+//! @param[in] fd the file
+//! @param[in] path the path of the file
+//! @param[in] off where the writes start
+//! @param[in] len how many bytes they cover
+//!
+//! @return TRUE if O_DIRECT was set on fd, FALSE if the writes go through the page cache
+//!
+static boolean diskutil_set_direct(int fd, const char *path, off_t off, long long len)
+{
+    int flags = 0;
+
+    if (!(diskutil_get_io_policy(path) & DISKUTIL_IO_POLICY_DIRECT) || (off % DISKUTIL_IO_ALIGN) || (len % DISKUTIL_IO_ALIGN))
+        return (FALSE);
 
-    LOGWARN("bad params: in=%s, out=%s\n", SP(in), SP(out));
-    return (EUCA_INVALID_ERROR);
+    // some file systems, tmpfs for one, refuse O_DIRECT
+    if (((flags = fcntl(fd, F_GETFL)) < 0) || (fcntl(fd, F_SETFL, (flags | O_DIRECT)) < 0)) {
+        LOGDEBUG("cannot bypass the page cache for %s (%s)\n", path, strerror(errno));
+        return (FALSE);
+    }
+    return (TRUE);
 }
 
 //!
+//! Copies 'count' blocks of size 'bs' from 'in', starting 'skip' blocks in, to 'out', starting
+//! 'seek' blocks in, the way diskutil_dd2() does but without running dd. The data is moved with
+//! copy_file_range() when possible, so that it need not go through user space, and the holes of
+//! a sparse source are skipped rather than read, leaving holes in the destination as well. The I/O
+//! policies of the files (see diskutil_set_io_policy()) decide whether the source is read ahead as
+//! sequential and whether the destination is written around the page cache or dropped from it as
+//! the copy goes. If the files cannot be opened by this process (device nodes owned by root, for instance) or the copy
+//! fails, diskutil_dd2() is called to do it.
 //!
-//!
-//! @param[in] in
-//! @param[in] out
-//! @param[in] bs
-//! @param[in] count
-//! @param[in] seek
-//! @param[in] skip
+//! @param[in] in path of the file or device to copy from
+//! @param[in] out path of the file or device to copy to
+//! @param[in] bs block size
+//! @param[in] count number of blocks to copy
+//! @param[in] seek number of blocks to skip in the destination
+//! @param[in] skip number of blocks to skip in the source
 //!
 //! @return EUCA_OK on success or the following error codes:
-//!         \li EUCA_ERROR: if we fail to copy the disk file
+//!         \li EUCA_ERROR: if we fail to copy the data
 //!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
 //!
 //! @pre Both in and out paramters must not be NULL.
 //!
 //! @post On success the data from 'in' has been copied in 'out'.
 //!
-int diskutil_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip)
+int diskutil_copy(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip)
 {
-    char *output = NULL;
+    int ifd = -1;
+    int ofd = -1;
+    int ret = EUCA_ERROR;
+    char *buf = NULL;
+    char *zbuf = NULL;
+    diskutil_io *io = NULL;
+    off_t pos = 0;
+    off_t end = 0;
+    off_t data = 0;
+    off_t hole = 0;
+    off_t ibase = 0;
+    off_t obase = 0;
+    long long len = 0;
+    long long copied = 0;
+    long long skipped = 0;
+    long long reported = 0;
+    boolean iregular = FALSE;
+    boolean oregular = FALSE;
+    boolean use_cfr = TRUE;
+    boolean direct = FALSE;
+    int ipolicy = diskutil_get_io_policy(in);
+    int opolicy = diskutil_get_io_policy(out);
+    long long dropped = 0;
+    struct stat istat = { 0 };
+    struct stat ostat = { 0 };
+
+    if (!in || !out || (bs < 1) || (count < 0) || (seek < 0) || (skip < 0)) {
+        LOGWARN("bad params: in=%s, out=%s\n", SP(in), SP(out));
+        return (EUCA_INVALID_ERROR);
+    }
 
-    if (in && out) {
-        LOGINFO("copying data from '%s'\n", in);
-        LOGINFO("               to '%s'\n", out);
-        LOGINFO("               of %lld blocks (bs=%d), seeking %lld, skipping %lld\n", count, bs, seek, skip);
+    if (((ifd = open(in, O_RDONLY)) < 0) || ((ofd = open(out, O_WRONLY | O_CREAT, 0666)) < 0) || fstat(ifd, &istat) || fstat(ofd, &ostat)
+        || posix_memalign((void **)&buf, DISKUTIL_IO_ALIGN, DISKUTIL_COPY_BUF_BYTES) || posix_memalign((void **)&zbuf, DISKUTIL_IO_ALIGN, DISKUTIL_COPY_BUF_BYTES)) {
+        LOGDEBUG("cannot copy '%s' to '%s' in-process (%s), falling back to dd\n", in, out, strerror(errno));
+        goto fallback;
+    }
+    // aligned, so that the buffered copy works on O_DIRECT files
+    bzero(zbuf, DISKUTIL_COPY_BUF_BYTES);
+
+    iregular = S_ISREG(istat.st_mode);
+    oregular = S_ISREG(ostat.st_mode);
+    ibase = ((off_t) skip) * bs;
+    obase = ((off_t) seek) * bs;
+    len = count * bs;
+    if (ipolicy & DISKUTIL_IO_POLICY_SEQUENTIAL)
+        posix_fadvise(ifd, ibase, len, POSIX_FADV_SEQUENTIAL);
+    direct = diskutil_set_direct(ofd, out, obase, len);
+    // only used for what copy_file_range() cannot do, but a ring costs little next to a disk copy
+    io = diskutil_io_open(ifd, ofd);
+
+    LOGINFO("copying data from '%s'\n", in);
+    LOGINFO("               to '%s'\n", out);
+    LOGINFO("               of %lld blocks (bs=%d), seeking %lld, skipping %lld\n", count, bs, seek, skip);
+
+    // walk the source a data region at a time, everything is data if it is not a sparse file
+    for (pos = 0; pos < len; pos = end) {
+        data = pos;
+        hole = len;
+#ifdef SEEK_DATA
+        if (iregular) {
+            if ((data = lseek(ifd, ibase + pos, SEEK_DATA)) < 0) {
+                // ENXIO means there is no data past this point, anything else means no hole support
+                data = ((errno == ENXIO) ? (ibase + len) : (ibase + pos));
+            }
+            data = (((data - ibase) < len) ? (data - ibase) : len);
+            if ((data < len) && ((hole = lseek(ifd, ibase + data, SEEK_HOLE)) >= 0)) {
+                hole = (((hole - ibase) < len) ? (hole - ibase) : len);
+            } else {
+                hole = len;
+            }
+        }
+#endif /* SEEK_DATA */
 
-        char if_str[EUCA_MAX_PATH] = "";
-        snprintf(if_str, sizeof(if_str), "if=%s", in);
-        char of_str[EUCA_MAX_PATH] = "";
-        snprintf(of_str, sizeof(of_str), "of=%s", out);
-        char bs_str[64];
-        snprintf(bs_str, sizeof(bs_str), "bs=%d", bs);
-        char count_str[64];
-        snprintf(count_str, sizeof(count_str), "count=%lld", count);
-        char seek_str[64];
-        snprintf(seek_str, sizeof(seek_str), "seek=%lld", seek);
-        char skip_str[64];
-        snprintf(skip_str, sizeof(skip_str), "skip=%lld", skip);
-        output = execlp_output(TRUE, helpers_path[ROOTWRAP], helpers_path[DD], if_str, of_str, bs_str, count_str, seek_str, skip_str, "conv=notrunc,fsync", NULL);
-        if (!output) {
-            LOGERROR("cannot copy '%s'\n", in);
-            LOGERROR("                to '%s'\n", out);
-            return (EUCA_ERROR);
+        if (data > pos) {
+            if (diskutil_zero_range(ofd, obase + pos, data - pos, oregular, zbuf, io) != EUCA_OK) {
+                LOGWARN("failed to zero %lld bytes at %lld in '%s' (%s), falling back to dd\n", (long long)(data - pos), (long long)(obase + pos), out, strerror(errno));
+                goto fallback;
+            }
+            skipped += (data - pos);
+        }
+        if (hole > data) {
+            if (diskutil_copy_data(ifd, ofd, ibase + data, obase + data, hole - data, buf, &use_cfr, io) != EUCA_OK) {
+                LOGWARN("failed to copy %lld bytes from '%s' to '%s' (%s), falling back to dd\n", (long long)(hole - data), in, out, strerror(errno));
+                goto fallback;
+            }
+            copied += (hole - data);
         }
+        end = ((hole > data) ? hole : len);
 
-        EUCA_FREE(output);
+        if (!direct && (opolicy & DISKUTIL_IO_POLICY_DONTNEED) && ((copied - dropped) >= DISKUTIL_DROP_BEHIND_BYTES)) {
+            dropped = copied;
+            diskutil_drop_behind(ofd, obase + end, DISKUTIL_DROP_BEHIND_BYTES);
+        }
+
+        if ((copied + skipped - reported) >= DISKUTIL_COPY_PROGRESS_BYTES) {
+            reported = copied + skipped;
+            LOGDEBUG("copied %lld of %lld bytes from '%s' (%d%%)\n", reported, len, in, (int)((reported * 100) / len));
+        }
+    }
+
+    // a hole punched at the end does not grow the file the way writing zeroes there would
+    if (oregular && (fstat(ofd, &ostat) == 0) && (ostat.st_size < (obase + len)) && ftruncate(ofd, obase + len)) {
+        LOGWARN("failed to extend '%s' to %lld bytes, falling back to dd\n", out, (long long)(obase + len));
+        goto fallback;
+    }
+    if (fsync(ofd)) {
+        LOGWARN("failed to flush '%s' (%s), falling back to dd\n", out, strerror(errno));
+        goto fallback;
+    }
+    if (!direct && (opolicy & DISKUTIL_IO_POLICY_DONTNEED))
+        posix_fadvise(ofd, obase, len, POSIX_FADV_DONTNEED);
+
+    LOGDEBUG("copied %lld bytes of data and %lld bytes of holes from '%s' to '%s'\n", copied, skipped, in, out);
+    ret = EUCA_OK;
+
+fallback:
+    diskutil_io_close(&io);
+    if (ifd >= 0)
+        close(ifd);
+    if (ofd >= 0)
+        close(ofd);
+    EUCA_FREE(buf);
+    EUCA_FREE(zbuf);
+
+    if (ret != EUCA_OK) {
+        ret = diskutil_dd2(in, out, bs, count, seek, skip);
+    }
+    return (ret);
+}
+
+//!
+//! Punches a hole into an open file, unless the range is empty
+//!
+//! @param[in] fd
+//! @param[in] start
+//! @param[in] end
+//!
+//! @return EUCA_OK on success, EUCA_UNSUPPORTED_ERROR if the file system cannot punch holes or EUCA_ERROR
+//!
+static int diskutil_punch(int fd, off_t start, off_t end)
+{
+    if (end <= start)
+        return (EUCA_OK);
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, start, end - start) == 0)
         return (EUCA_OK);
+    return (((errno == EOPNOTSUPP) || (errno == ENOSYS)) ? EUCA_UNSUPPORTED_ERROR : EUCA_ERROR);
+#else /* FALLOC_FL_PUNCH_HOLE */
+    return (EUCA_UNSUPPORTED_ERROR);
+#endif /* FALLOC_FL_PUNCH_HOLE */
+}
+
+//!
+//! Gives back to the file system the space that a regular file spends on zeroes, by punching
+//! holes where it holds nothing but zeroes. Only the data regions of the file are read, and
+//! only aligned runs of at least DISKUTIL_PUNCH_MIN_BYTES are punched out, as smaller holes
+//! would fragment the file for little gain. Reads of the file return the same as before, and
+//! its access and modification times are left as they were, so the caller decides whether
+//! anyone may be writing to the file in the meantime.
+//!
+//! @param[in]  path path of the file
+//! @param[out] reclaimed_bytes how much less space the file takes on disk, if not NULL
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if the path is NULL or not that of a regular file
+//!         \li EUCA_UNSUPPORTED_ERROR: if the file system cannot punch holes
+//!         \li EUCA_ERROR: if we fail to read the file or to punch a hole
+//!
+int diskutil_punch_zeros(const char *path, long long *reclaimed_bytes)
+{
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    char *buf = NULL;
+    off_t pos = 0;
+    off_t off = 0;
+    off_t data = 0;
+    off_t hole = 0;
+    off_t run_start = 0;
+    off_t run_end = 0;
+    ssize_t got = 0;
+    ssize_t i = 0;
+    struct stat before = { 0 };
+    struct stat after = { 0 };
+    struct timespec times[2];
+
+    if (reclaimed_bytes)
+        *reclaimed_bytes = 0;
+    if (path == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    if (((fd = open(path, O_RDWR)) < 0) || fstat(fd, &before)) {
+        LOGWARN("failed to open '%s' for punching holes (%s)\n", path, strerror(errno));
+        goto cleanup;
+    }
+    if (!S_ISREG(before.st_mode)) {
+        ret = EUCA_INVALID_ERROR;
+        goto cleanup;
+    }
+    if ((buf = EUCA_ALLOC(DISKUTIL_COPY_BUF_BYTES, 1)) == NULL)
+        goto cleanup;
+
+    // walk the file a data region at a time, everything is data if holes cannot be found
+    for (pos = 0; pos < before.st_size; pos = hole) {
+        data = pos;
+        hole = before.st_size;
+#ifdef SEEK_DATA
+        if ((data = lseek(fd, pos, SEEK_DATA)) < 0) {
+            if (errno == ENXIO)
+                break;                 // nothing but holes past this point
+            data = pos;
+        } else if ((hole = lseek(fd, data, SEEK_HOLE)) < 0) {
+            hole = before.st_size;
+        }
+#endif /* SEEK_DATA */
+
+        // start at a run boundary, the part of the run before the data is a hole that reads as zeroes anyway
+        run_start = run_end = -1;
+        for (off = data - (data % DISKUTIL_PUNCH_MIN_BYTES); off < hole; off += got) {
+            if ((got = pread(fd, buf, (((hole - off) < DISKUTIL_COPY_BUF_BYTES) ? (hole - off) : DISKUTIL_COPY_BUF_BYTES), off)) <= 0) {
+                if ((got < 0) && (errno == EINTR)) {
+                    got = 0;
+                    continue;
+                }
+                LOGWARN("failed to read '%s' at %lld (%s)\n", path, (long long)off, strerror(errno));
+                goto cleanup;
+            }
+
+            for (i = 0; i < got; i += DISKUTIL_PUNCH_MIN_BYTES) {
+                ssize_t len = (((got - i) < DISKUTIL_PUNCH_MIN_BYTES) ? (got - i) : DISKUTIL_PUNCH_MIN_BYTES);
+                if ((len == DISKUTIL_PUNCH_MIN_BYTES) && (buf[i] == 0) && !memcmp(buf + i, buf + i + 1, len - 1)) {
+                    if (run_start < 0)
+                        run_start = off + i;
+                    run_end = off + i + len;
+                } else if (run_start >= 0) {
+                    if ((ret = diskutil_punch(fd, run_start, run_end)) != EUCA_OK)
+                        goto cleanup;
+                    ret = EUCA_ERROR;
+                    run_start = run_end = -1;
+                }
+            }
+        }
+        if ((run_start >= 0) && ((ret = diskutil_punch(fd, run_start, run_end)) != EUCA_OK))
+            goto cleanup;
+        ret = EUCA_ERROR;
     }
 
-    LOGWARN("bad params: in=%s, out=%s\n", SP(in), SP(out));
-    return (EUCA_INVALID_ERROR);
+    // the content did not change, so neither should the times by which the file is judged
+    times[0] = before.st_atim;
+    times[1] = before.st_mtim;
+    if (futimens(fd, times)) {
+        LOGWARN("failed to restore the times of '%s' (%s)\n", path, strerror(errno));
+    }
+    if (reclaimed_bytes && (fstat(fd, &after) == 0) && (after.st_blocks < before.st_blocks)) {
+        *reclaimed_bytes = ((long long)(before.st_blocks - after.st_blocks)) * 512;
+    }
+    ret = EUCA_OK;
+
+cleanup:
+    if (fd >= 0)
+        close(fd);
+    EUCA_FREE(buf);
+    return (ret);
 }
 
 //!
@@ -692,8 +1987,17 @@ int diskutil_loop_check(const char *path, const char *lodev)
     char *output = NULL;
     char *oparen = NULL;
     char *cparen = NULL;
+    char real_path[PATH_MAX] = "";
+    char backing[PATH_MAX] = "";
 
     if (path && lodev) {
+        // the kernel publishes the full backing path in sysfs, which is exact and needs no privileges
+        if (loop_backing_file(lodev, backing, sizeof(backing)) == EUCA_OK) {
+            if (realpath(path, real_path) == NULL)
+                euca_strncpy(real_path, path, sizeof(real_path));
+            return ((strcmp(backing, real_path) == 0) ? EUCA_OK : EUCA_ERROR);
+        }
+
         output = pruntf(TRUE, "%s %s %s", helpers_path[ROOTWRAP], helpers_path[LOSETUP], lodev);
         if (output == NULL)
             return (EUCA_ERROR);
@@ -759,6 +2063,14 @@ int diskutil_loop(const char *path, const long long offset, char *lodev, int lod
     boolean do_log = FALSE;
 
     if (path && lodev) {
+        // when this process may use the loop control device, the kernel hands out the free
+        // devices, so there is nothing to serialize on and no helper to run
+        if (loop_direct) {
+            if ((ret = loop_attach_direct(path, offset, lodev, lodev_size)) == EUCA_OK)
+                return (EUCA_OK);
+            LOGWARN("failed to attach %s directly, falling back to losetup\n", path);
+            ret = EUCA_OK;
+        }
         // we retry because we cannot atomically obtain a free loopback device on all distros (some
         // versions of 'losetup' allow a file argument with '-f' options, but some do not)
         for (i = 0, done = FALSE, found = FALSE; i < LOOP_RETRIES; i++) {
@@ -848,6 +2160,18 @@ int diskutil_unloop(const char *lodev)
         //     ioctl: LOOP_CLR_FD: Device or resource bus
         for (i = 0; i < LOOP_RETRIES; i++) {
             do_log = ((i + 1) == LOOP_RETRIES); // log error on last try only
+            if (loop_direct) {
+                if ((ret = loop_detach_direct(lodev)) == EUCA_OK)
+                    break;
+                if (errno == EBUSY) {
+                    LOGDEBUG("cannot detach loop device %s (will retry)\n", lodev);
+                    retried++;
+                    sleep(1);
+                    continue;
+                }
+                // otherwise the device may be out of our reach, so let losetup try
+            }
+
             sem_p(loop_sem);
             {
                 output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "-d", lodev, NULL);
@@ -947,6 +2271,43 @@ int diskutil_mkfs(const char *lodev, const long long size_bytes)
     return (EUCA_INVALID_ERROR);
 }
 
+//!
+//! Formats a regular file as ext3, without a loop device or root privileges, so that the
+//! file can be copied into a partition afterwards
+//!
+//! @param[in] path
+//! @param[in] size_bytes
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_ERROR: if any error occured.
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions.
+//!
+//! @pre The path parameters must not be NULL.
+//!
+//! @post On success, the file holds an empty ext3 file system.
+//!
+//! @see diskutil_mkfs()
+//!
+int diskutil_mkfs_file(const char *path, const long long size_bytes)
+{
+    int block_size = 4096;
+    char *output = NULL;
+
+    if (path) {
+        output = pruntf(TRUE, "%s -F -q -b %d %s %lld", helpers_path[MKEXT3], block_size, path, size_bytes / block_size);
+        if (!output) {
+            LOGERROR("cannot format file '%s' as ext3\n", path);
+            return (EUCA_ERROR);
+        }
+
+        EUCA_FREE(output);
+        return (EUCA_OK);
+    }
+
+    LOGWARN("cannot format file as ext3. path=%s\n", SP(path));
+    return (EUCA_INVALID_ERROR);
+}
+
 //!
 //!
 //!
@@ -1616,46 +2977,26 @@ int diskutil_cp(const char *from, const char *to)
 static char *pruntf(boolean log_error, char *format, ...)
 {
     va_list ap;
-    FILE *IF = NULL;
     int rc = -1;
-    int outsize = 1025;
     char cmd[1024] = { 0 };
-    size_t bytes = 0;
     char *output = NULL;
 
     va_start(ap, format);
     vsnprintf(cmd, 1024, format, ap);
+    va_end(ap);
 
-    strncat(cmd, " 2>&1", 1024 - 1);
-    output = NULL;
-
-    IF = popen(cmd, "r");
-    if (!IF) {
-        LOGERROR("cannot popen() cmd '%s' for read\n", cmd);
-        va_end(ap);
+    if ((rc = euca_run_shell(cmd, EUCA_RUN_MERGE_STDERR, 0, &output, NULL, NULL)) == EUCA_THREAD_ERROR) {
+        LOGERROR("cannot run cmd '%s'\n", cmd);
+        EUCA_FREE(output);
         return (NULL);
     }
 
-    output = EUCA_ALLOC(outsize, sizeof(char));
-    if (output) {
-        output[0] = '\0';              // make sure we return an empty string if there is no output
-    }
-
-    while ((output != NULL) && (bytes = fread(output + (outsize - 1025), 1, 1024, IF)) > 0) {
-        output[(outsize - 1025) + bytes] = '\0';
-        outsize += 1024;
-        output = EUCA_REALLOC(output, outsize, sizeof(char));
-    }
-
     if (output == NULL) {
         LOGERROR("failed to allocate mem for output\n");
-        va_end(ap);
-        pclose(IF);
         return (NULL);
     }
 
-    rc = pclose(IF);
-    if (rc) {
+    if (rc != EUCA_OK) {
         //! @TODO improve this hacky special case: failure to find or detach non-existing loop device is not a failure
         if (strstr(cmd, "losetup") && strstr(output, ": No such device or address")) {
             rc = 0;
@@ -1667,7 +3008,6 @@ static char *pruntf(boolean log_error, char *format, ...)
             EUCA_FREE(output);
         }
     }
-    va_end(ap);
 
     return (output);
 }
@@ -1722,77 +3062,23 @@ static char *execlp_output(boolean log_error, ...)
     va_end(ap);
 
     char *output = NULL;
+    int rc = -1;
+    int status = 0;
 
-    // set up a pipe for getting stdout and stderror from child process
-    int filedes[2];
-    if (pipe(filedes)) {
-        LOGERROR("failed to create a pipe\n");
-        goto free;
-    }
+    // stdout and stderr of the command, together; a rootwrap'ed command may be run by the privileged helper
     LOGTRACE("executing: %s\n", cmd);
-
-    pid_t cpid = fork();
-    int rc = -1;
-    if (cpid == -1) {
-        LOGERROR("failed to fork\n");
-        close(filedes[0]);
-        close(filedes[1]);
-        goto free;
-    } else if (cpid == 0) {            // child
-        close(filedes[0]);
-        if (dup2(filedes[1], STDOUT_FILENO) == -1) {
-            LOGERROR("failed to dup2\n");
-            exit(-1);
-        }
-        if (dup2(filedes[1], STDERR_FILENO) == -1) {
-            LOGERROR("failed to dup2\n");
-            exit(-1);
-        }
-        exit(execvp(argv[0], argv));
-    }
-    // parent reads stdout and stdin from child into a string
-    close(filedes[1]);
-
-    int outsize = OUTPUT_ALLOC_CHUNK;  // allocate in chunks of this size
-    int nextchar = 0;                  // offset of the next usable char
-    int bytesread;
-    output = EUCA_ALLOC(outsize, sizeof(char));
-    if (output) {
-        output[0] = '\0';              // return an empty string if there is no output
-    }
-
-    while ((output != NULL) && (bytesread = read(filedes[0], output + nextchar, outsize - nextchar - 1)) > 0) {
-        nextchar += bytesread;
-        output[nextchar] = '\0';
-        if (nextchar + 1 == outsize) {
-            outsize += OUTPUT_ALLOC_CHUNK;
-            if (outsize > MAX_OUTPUT_BYTES) {
-                LOGERROR("internal error: output from command is too long\n");
-                EUCA_FREE(output);
-                break;
-            }
-            output = EUCA_REALLOC(output, outsize, sizeof(char));
-        }
-    }
-    if (output == NULL) {
+    if ((rc = euca_run(argv, NULL, EUCA_RUN_MERGE_STDERR, 0, &output, NULL, &status)) == EUCA_MEMORY_ERROR) {
         LOGERROR("failed to allocate mem for output\n");
+        EUCA_FREE(output);
+    } else if ((output != NULL) && (strlen(output) > (MAX_OUTPUT_BYTES))) {
+        LOGERROR("internal error: output from command is too long\n");
+        EUCA_FREE(output);
     }
-    close(filedes[0]);
-
-    {                                  // wait for the child to reap status
-        int status;
-        rc = waitpid(cpid, &status, 0);
-        if (rc == -1) {
-            LOGERROR("failed to wait for child process\n");
-        } else if (WIFEXITED(status)) {
-            rc = WEXITSTATUS(status);
-            if (rc) {
-                LOGERROR("child return non-zero status (%d)\n", rc);
-            }
-        } else {
-            LOGERROR("child process did not terminate normally\n");
-            rc = -1;
-        }
+
+    if (rc == EUCA_ERROR) {
+        LOGERROR("child return non-zero status (%d)\n", WEXITSTATUS(status));
+    } else if (rc != EUCA_OK) {
+        LOGERROR("child process did not terminate normally\n");
     }
 
     if (rc) {
@@ -1808,7 +3094,6 @@ static char *execlp_output(boolean log_error, ...)
         }
     }
 
-free:
     for (int i = 0; i < ntokens; i++) {
         EUCA_FREE(argv[i]);
     }
@@ -1904,3 +3189,229 @@ int main(int argc, char *argv[])
 }
 
 #endif // _UNIT_TEST
+
+//!
+//! Checks whether this process may attach loopback devices itself through the loop
+//! control device (as root does, or a user in the group owning it) and, if so,
+//! creates the first LOOP_POOL_SIZE devices, so that launch bursts do not wait on
+//! device nodes being made. The kernel tracks which of them are free.
+//!
+static void loop_pool_init(void)
+{
+    int i = 0;
+    int ctl = -1;
+    int created = 0;
+
+    loop_direct = FALSE;
+    if ((ctl = open(LOOP_CONTROL_DEV, O_RDWR | O_CLOEXEC)) < 0) {
+        LOGDEBUG("attaching loopback devices through losetup (%s: %s)\n", LOOP_CONTROL_DEV, strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < LOOP_POOL_SIZE; i++) {
+        if (ioctl(ctl, LOOP_CTL_ADD, i) >= 0)
+            created++;
+    }
+    close(ctl);
+
+    loop_direct = TRUE;
+    LOGINFO("attaching loopback devices directly (%d of %d pool devices created)\n", created, LOOP_POOL_SIZE);
+}
+
+//!
+//! Binds a backing file to an open loopback device, with direct I/O when the file allows
+//! it, so that its pages are not cached twice. Uses the single LOOP_CONFIGURE call where
+//! the kernel has it (5.8 and later) and LOOP_SET_FD with LOOP_SET_STATUS64 otherwise.
+//!
+//! @param[in] lfd the loopback device
+//! @param[in] ffd the backing file
+//! @param[in] path of the backing file, recorded in the device
+//! @param[in] offset in the backing file
+//! @param[in] read_only TRUE if the file was opened read-only
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, with errno set
+//!
+static int loop_configure(int lfd, int ffd, const char *path, const long long offset, boolean read_only)
+{
+    struct loop_info64 info = { 0 };
+
+    info.lo_offset = offset;
+    info.lo_flags = (read_only ? LO_FLAGS_READ_ONLY : 0);
+    euca_strncpy((char *)info.lo_file_name, path, LO_NAME_SIZE);
+
+#ifdef LOOP_CONFIGURE
+    {
+        struct loop_config config = { 0 };
+
+        config.fd = ffd;
+        config.info = info;
+        config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+        if (ioctl(lfd, LOOP_CONFIGURE, &config) >= 0)
+            return (EUCA_OK);
+
+        if (errno == EINVAL) {
+            // not every file system does direct I/O, and not every offset is aligned for it
+            config.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+            if (ioctl(lfd, LOOP_CONFIGURE, &config) >= 0)
+                return (EUCA_OK);
+        }
+
+        if ((errno != EINVAL) && (errno != ENOTTY))
+            return (EUCA_ERROR);
+        // otherwise the running kernel predates LOOP_CONFIGURE
+    }
+#endif /* LOOP_CONFIGURE */
+
+    if (ioctl(lfd, LOOP_SET_FD, ffd) < 0)
+        return (EUCA_ERROR);
+
+    if (ioctl(lfd, LOOP_SET_STATUS64, &info) < 0) {
+        int saved = errno;
+        ioctl(lfd, LOOP_CLR_FD, 0);
+        errno = saved;
+        return (EUCA_ERROR);
+    }
+#ifdef LOOP_SET_DIRECT_IO
+    ioctl(lfd, LOOP_SET_DIRECT_IO, 1UL);    // best effort
+#endif /* LOOP_SET_DIRECT_IO */
+    return (EUCA_OK);
+}
+
+//!
+//! Attaches a file to a free loopback device without running losetup. The kernel hands
+//! out free devices atomically (creating one if none is left), so the only race is with
+//! another process binding the same device first, and that costs a retry, not a sleep.
+//!
+//! @param[in]  path
+//! @param[in]  offset
+//! @param[out] lodev name of the loop device
+//! @param[in]  lodev_size
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int loop_attach_direct(const char *path, const long long offset, char *lodev, int lodev_size)
+{
+    int i = 0;
+    int n = 0;
+    int ctl = -1;
+    int ffd = -1;
+    int lfd = -1;
+    int ret = EUCA_ERROR;
+    boolean read_only = FALSE;
+
+    if ((ffd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        if ((errno != EROFS) && (errno != EACCES)) {
+            LOGERROR("cannot open %s: %s\n", path, strerror(errno));
+            return (EUCA_ERROR);
+        }
+        if ((ffd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            LOGERROR("cannot open %s: %s\n", path, strerror(errno));
+            return (EUCA_ERROR);
+        }
+        read_only = TRUE;
+    }
+
+    if ((ctl = open(LOOP_CONTROL_DEV, O_RDWR | O_CLOEXEC)) < 0) {
+        LOGERROR("cannot open %s: %s\n", LOOP_CONTROL_DEV, strerror(errno));
+        close(ffd);
+        return (EUCA_ERROR);
+    }
+
+    for (i = 0; i < LOOP_GRAB_RETRIES; i++) {
+        if ((n = ioctl(ctl, LOOP_CTL_GET_FREE)) < 0) {
+            LOGERROR("cannot find free loop device: %s\n", strerror(errno));
+            break;
+        }
+
+        snprintf(lodev, lodev_size, "/dev/loop%d", n);
+        if ((lfd = open(lodev, (read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC)) < 0) {
+            if (errno == ENOENT) {
+                // a freshly created device whose node is still on its way
+                usleep(1000);
+                continue;
+            }
+            LOGERROR("cannot open %s: %s\n", lodev, strerror(errno));
+            break;
+        }
+
+        if (loop_configure(lfd, ffd, path, offset, read_only) == EUCA_OK) {
+            LOGDEBUG("attached file %s\n", path);
+            LOGDEBUG("         to %s at offset %lld\n", lodev, offset);
+            ret = EUCA_OK;
+            close(lfd);
+            break;
+        }
+
+        if (errno != EBUSY) {
+            LOGERROR("cannot attach %s to %s: %s\n", path, lodev, strerror(errno));
+            close(lfd);
+            break;
+        }
+        // somebody else took this one between our asking and binding
+        close(lfd);
+    }
+
+    close(ctl);
+    close(ffd);
+    return (ret);
+}
+
+//!
+//! Detaches a loopback device without running losetup
+//!
+//! @param[in] lodev name of the loop device
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, with errno set
+//!
+static int loop_detach_direct(const char *lodev)
+{
+    int lfd = -1;
+    int saved = 0;
+
+    if ((lfd = open(lodev, O_RDONLY | O_CLOEXEC)) < 0)
+        return (EUCA_ERROR);
+
+    if (ioctl(lfd, LOOP_CLR_FD, 0) < 0) {
+        saved = errno;
+        close(lfd);
+        errno = saved;
+        return (EUCA_ERROR);
+    }
+
+    close(lfd);
+    return (EUCA_OK);
+}
+
+//!
+//! Reads the full path of the file behind a loopback device from sysfs
+//!
+//! @param[in]  lodev name of the loop device, such as /dev/loop4
+//! @param[out] path
+//! @param[in]  path_size
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the device is not attached or sysfs does not tell
+//!
+static int loop_backing_file(const char *lodev, char *path, int path_size)
+{
+    int len = 0;
+    FILE *fp = NULL;
+    const char *name = NULL;
+    char sys_path[EUCA_MAX_PATH] = "";
+
+    if ((name = strrchr(lodev, '/')) == NULL)
+        return (EUCA_ERROR);
+
+    snprintf(sys_path, sizeof(sys_path), "/sys/block/%s/loop/backing_file", name + 1);
+    if ((fp = fopen(sys_path, "r")) == NULL)
+        return (EUCA_ERROR);
+
+    if (fgets(path, path_size, fp) == NULL) {
+        fclose(fp);
+        return (EUCA_ERROR);
+    }
+    fclose(fp);
+
+    if (((len = strlen(path)) > 0) && (path[len - 1] == '\n'))
+        path[len - 1] = '\0';
+    return (EUCA_OK);
+}
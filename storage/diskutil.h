@@ -77,6 +77,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <sys/types.h>                 // off_t
 #include "misc.h"                      // bolean
 #include "ipc.h"                       // sem
 
@@ -93,12 +94,21 @@
 #define MBR_BLOCKS                                63    //!< the size of "DOS-compatibility region" partially used by 'grub'
 #define SECTOR_SIZE                              512
 
+//! @{
+//! @name I/O policies of the files under a directory, see diskutil_set_io_policy()
+#define DISKUTIL_IO_POLICY_DIRECT                0x01   //!< bulk writes of the files bypass the page cache (O_DIRECT) when they are aligned for it
+#define DISKUTIL_IO_POLICY_DONTNEED              0x02   //!< what is written to the files is dropped from the page cache once it is on disk
+#define DISKUTIL_IO_POLICY_SEQUENTIAL            0x04   //!< bulk reads of the files are announced as sequential, for a larger readahead
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+typedef struct diskutil_io_t diskutil_io;   //!< an asynchronous I/O engine between two open files, see diskutil_io_open()
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -138,6 +148,18 @@ int diskutil_cleanup(void);
 int diskutil_ddzero(const char *path, const long long sectors, boolean zero_fill);
 int diskutil_dd(const char *in, const char *out, const int bs, const long long count);
 int diskutil_dd2(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip);
+int diskutil_copy(const char *in, const char *out, const int bs, const long long count, const long long seek, const long long skip);
+int diskutil_punch_zeros(const char *path, long long *reclaimed_bytes);
+diskutil_io *diskutil_io_open(int ifd, int ofd);
+int diskutil_io_copy(diskutil_io * io, off_t ioff, off_t ooff, long long len);
+int diskutil_io_fill(diskutil_io * io, off_t ooff, long long len, int c);
+int diskutil_io_write(diskutil_io * io, const char *buf, size_t len, off_t off);
+int diskutil_io_flush(diskutil_io * io);
+void diskutil_io_close(diskutil_io ** pio);
+int diskutil_parse_io_policy(const char *str, int *policy);
+int diskutil_set_io_policy(const char *dir, int policy);
+int diskutil_get_io_policy(const char *path);
+void diskutil_drop_behind(int fd, off_t end, off_t lag);
 int diskutil_mbr(const char *path, const char *type);
 int diskutil_part(const char *path, char *part_type, const char *fs_type, const long long first_sector, const long long last_sector);
 int diskutil_get_parts(const char *path, struct partition_table_entry entries[], int num_entries);
@@ -147,6 +169,7 @@ int diskutil_loop(const char *path, const long long offset, char *lodev, int lod
 int diskutil_unloop(const char *lodev);
 int diskutil_mkswap(const char *lodev, const long long size_bytes);
 int diskutil_mkfs(const char *lodev, const long long size_bytes);
+int diskutil_mkfs_file(const char *path, const long long size_bytes);
 int diskutil_tune(const char *lodev);
 int diskutil_sectors(const char *path, const int part, long long *first, long long *last);
 int diskutil_mount(const char *dev, const char *mnt_pt);
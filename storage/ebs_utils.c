@@ -77,12 +77,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <misc.h>
 #include <euca_string.h>
 #include <eucalyptus.h>
 #include <iscsi.h>
 #include <log.h>
 #include <euca_auth.h>
+#include <trace.h>
 #include "storage-controller.h"
 #include "ebs_utils.h"
 
@@ -92,6 +94,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define SC_TOKEN_CACHE_SIZE                      64 //!< most volumes whose re-encrypted token is cached at once
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -138,6 +142,16 @@ const char *euca_client_component_name = "nc";  //!< The client component name
 static sem *vol_sem = NULL;            //!< Semaphore to protect volume operations
 static int request_timeout_sec = DEFAULT_SC_REQUEST_TIMEOUT;
 
+//! Attachment tokens re-encrypted for the SC, kept for as long as the volume is attached, see get_sc_token()
+static struct {
+    char volumeId[128];                //!< the volume (empty if the entry is free)
+    char token[EBS_TOKEN_MAX_LENGTH];  //!< the attachment token, as encrypted with the NC key
+    char *sc_token;                    //!< the same token re-encrypted with the cloud key
+} sc_token_cache[SC_TOKEN_CACHE_SIZE];
+
+static pthread_mutex_t sc_token_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< protects sc_token_cache
+static int sc_token_next = 0;          //!< entry replaced next when the cache is full
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -148,6 +162,8 @@ static int cleanup_volume_attachment(char *sc_url, int use_ws_sec, char *ws_sec_
                                      int do_rescan);
 static int redact_token(char *src_token, char *redacted);   //! Returns a redacted version of the token (eg. 'advaoiaavae' -> '*****avae'
 static int re_encrypt_token(char *in_token, char **out_token);  //! Decrypts token with NC cert and re-encrypts with the cloud public cert
+static int get_sc_token(ebs_volume_data * vol_data, char **out_token);  //! Cached version of re_encrypt_token() for the token of a volume
+static void forget_sc_token(ebs_volume_data * vol_data);   //! Drops the cached re-encrypted token of a volume
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -165,6 +181,9 @@ static int re_encrypt_token(char *in_token, char **out_token);  //! Decrypts tok
 //! Initialize ebs data structures and semaphores for EBS
 //! Should only be called once!
 //!
+//! @param[in] sc_request_timeout_sec timeout, in seconds, of the requests to the SC
+//! @param[in] use_sc_pool set to TRUE to make SC requests through pooled, long-lived SC stubs
+//!
 //! @return
 //!
 //! @pre
@@ -173,10 +192,11 @@ static int re_encrypt_token(char *in_token, char **out_token);  //! Decrypts tok
 //!
 //! @note
 //!
-int init_ebs_utils(int sc_request_timeout_sec)
+int init_ebs_utils(int sc_request_timeout_sec, int use_sc_pool)
 {
     LOGDEBUG("Initializing EBS utils\n");
     request_timeout_sec = sc_request_timeout_sec;
+    scClientUsePool(use_sc_pool);
     if (vol_sem == NULL) {
         vol_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
     }
@@ -358,7 +378,7 @@ int connect_ebs_volume(const char *target_dev, const char *target_serial, const
     }
 
     LOGTRACE("Parsed volume info: volumeId=%s, encrypted token=%s\n", (*vol_data)->volumeId, (*vol_data)->token);
-    if (re_encrypt_token((*vol_data)->token, &reencrypted_token) != EUCA_OK || reencrypted_token == NULL || strlen(reencrypted_token) <= 0) {
+    if (get_sc_token((*vol_data), &reencrypted_token) != EUCA_OK || reencrypted_token == NULL || strlen(reencrypted_token) <= 0) {
         LOGERROR("Failed on re-encryption of token for call to SC\n");
         if (reencrypted_token != NULL) {
             EUCA_FREE(reencrypted_token);
@@ -372,9 +392,13 @@ int connect_ebs_volume(const char *target_dev, const char *target_serial, const
 
     LOGTRACE("Calling ExportVolume on SC at %s\n", sc_url);
     threadCorrelationId *corr_id = get_corrid();
-    if (scClientCall
-        (corr_id != NULL ? corr_id->correlation_id : NULL, NULL, use_ws_sec, ws_sec_policy_file, request_timeout_sec, sc_url, "ExportVolume", (*vol_data)->volumeId,
-         reencrypted_token, local_ip, local_iqn, &connect_string) != EUCA_OK) {
+    int span = trace_begin_client("ExportVolume", (corr_id != NULL ? corr_id->correlation_id : NULL));
+    char *outgoing_corr_id = trace_outgoing_corrid(corr_id != NULL ? corr_id->correlation_id : NULL);
+    int rc = scClientCall((outgoing_corr_id != NULL ? outgoing_corr_id : (corr_id != NULL ? corr_id->correlation_id : NULL)), NULL, use_ws_sec, ws_sec_policy_file,
+                          request_timeout_sec, sc_url, "ExportVolume", (*vol_data)->volumeId, reencrypted_token, local_ip, local_iqn, &connect_string);
+    trace_end(span, (rc != EUCA_OK));
+    EUCA_FREE(outgoing_corr_id);
+    if (rc != EUCA_OK) {
         LOGERROR("Failed to get connection information for volume %s from storage controller at: %s\n", (*vol_data)->volumeId, sc_url);
         ret = EUCA_ERROR;
         goto release;
@@ -387,11 +411,13 @@ int connect_ebs_volume(const char *target_dev, const char *target_serial, const
     }
 
     //copy the connection info from the SC return to the resourceLocation.
+    span = trace_begin("iscsi.connect");
     xml = connect_iscsi_target((*vol_data)->volumeId,
                                target_dev,
                                target_serial,
                                target_bus,
                                (*vol_data)->connect_string);
+    trace_end(span, (xml == NULL));
     if (!xml) {
         LOGERROR("Failed to connect to EBS target: %s\n", (*vol_data)->connect_string);
         //disconnect the volume
@@ -414,6 +440,8 @@ release:
     }
 
     if (ret != EUCA_OK && (*vol_data) != NULL) {
+        //The volume is not attached, so its token is no longer needed
+        forget_sc_token((*vol_data));
         //Free the vol data struct too
         EUCA_FREE(*vol_data);
     }
@@ -560,7 +588,7 @@ static int cleanup_volume_attachment(char *sc_url, int use_ws_sec, char *ws_sec_
         return EUCA_ERROR;
     }
 
-    rc = re_encrypt_token(vol_data->token, &reencrypted_token);
+    rc = get_sc_token(vol_data, &reencrypted_token);
     if (rc != EUCA_OK || reencrypted_token == NULL || strlen(reencrypted_token) <= 0) {
         LOGERROR("Failed on re-encryption of token for call to SC\n");
         if (reencrypted_token != NULL) {
@@ -577,10 +605,13 @@ static int cleanup_volume_attachment(char *sc_url, int use_ws_sec, char *ws_sec_
         (corr_id == NULL ? NULL : corr_id->correlation_id, NULL, use_ws_sec, ws_sec_policy_file, request_timeout_sec, sc_url, "UnexportVolume", vol_data->volumeId,
          reencrypted_token, local_ip, local_iqn) != EUCA_OK) {
         EUCA_FREE(reencrypted_token);
+        // re-encrypt on a retry, in case the SC refused the token because the cloud key changed
+        forget_sc_token(vol_data);
         LOGERROR("ERROR unexporting volume %s\n", vol_data->volumeId);
         return EUCA_ERROR;
     } else {
         EUCA_FREE(reencrypted_token);
+        forget_sc_token(vol_data);
         //Ok, now refresh local session to be sure it's gone.
         //Should return error of not found.
         refreshedDev = get_iscsi_target(connect_string);
@@ -637,9 +668,118 @@ static int re_encrypt_token(char *in_token, char **out_token)
         return EUCA_ERROR;
     }
 
+    EUCA_FREE(tmp_token);
+    return EUCA_OK;
+}
+
+//!
+//! Gets the attachment token of a volume re-encrypted with the cloud public cert, as
+//! re_encrypt_token() does, but only does the RSA work the first time it is asked for
+//! a given volume and token. The result is then kept until forget_sc_token() is called
+//! for the volume, i.e. for as long as the volume is attached to this host.
+//!
+//! @param[in]  vol_data - the volume whose token is needed
+//! @param[out] out_token - a newly allocated copy of the re-encrypted token, caller must free it
+//!
+//! @return EUCA_OK on success, EUCA_ERROR on failure
+//!
+static int get_sc_token(ebs_volume_data * vol_data, char **out_token)
+{
+    int i = 0;
+    int slot = -1;
+    char *sc_token = NULL;
+    char *evicted = NULL;
+
+    *out_token = NULL;
+    if (vol_data == NULL) {
+        return EUCA_ERROR;
+    }
+
+    pthread_mutex_lock(&sc_token_mutex);
+    {
+        for (i = 0; i < SC_TOKEN_CACHE_SIZE; i++) {
+            if (sc_token_cache[i].sc_token && !strcmp(sc_token_cache[i].volumeId, vol_data->volumeId) && !strcmp(sc_token_cache[i].token, vol_data->token)) {
+                *out_token = strdup(sc_token_cache[i].sc_token);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sc_token_mutex);
+
+    if (*out_token != NULL) {
+        LOGTRACE("[%s] using cached re-encrypted token\n", vol_data->volumeId);
+        return EUCA_OK;
+    }
+
+    if (re_encrypt_token(vol_data->token, out_token) != EUCA_OK || *out_token == NULL) {
+        return EUCA_ERROR;
+    }
+
+    if ((sc_token = strdup(*out_token)) == NULL) {
+        // the caller still has its copy, the token just won't be cached
+        return EUCA_OK;
+    }
+
+    pthread_mutex_lock(&sc_token_mutex);
+    {
+        for (i = 0; i < SC_TOKEN_CACHE_SIZE; i++) {
+            if (sc_token_cache[i].volumeId[0] == '\0') {
+                if (slot < 0)
+                    slot = i;
+            } else if (!strcmp(sc_token_cache[i].volumeId, vol_data->volumeId)) {
+                // replaces the token of an earlier attachment of the volume
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            slot = sc_token_next;
+            sc_token_next = (sc_token_next + 1) % SC_TOKEN_CACHE_SIZE;
+        }
+
+        evicted = sc_token_cache[slot].sc_token;
+        euca_strncpy(sc_token_cache[slot].volumeId, vol_data->volumeId, sizeof(sc_token_cache[slot].volumeId));
+        euca_strncpy(sc_token_cache[slot].token, vol_data->token, sizeof(sc_token_cache[slot].token));
+        sc_token_cache[slot].sc_token = sc_token;
+    }
+    pthread_mutex_unlock(&sc_token_mutex);
+
+    EUCA_FREE(evicted);
     return EUCA_OK;
 }
 
+//!
+//! Drops the cached re-encrypted token of a volume, if any, once the volume is no longer
+//! attached to this host (or the SC refused the token).
+//!
+//! @param[in] vol_data - the volume whose token is dropped
+//!
+static void forget_sc_token(ebs_volume_data * vol_data)
+{
+    int i = 0;
+    char *evicted = NULL;
+
+    if (vol_data == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&sc_token_mutex);
+    {
+        for (i = 0; i < SC_TOKEN_CACHE_SIZE; i++) {
+            if (sc_token_cache[i].volumeId[0] != '\0' && !strcmp(sc_token_cache[i].volumeId, vol_data->volumeId)) {
+                evicted = sc_token_cache[i].sc_token;
+                sc_token_cache[i].sc_token = NULL;
+                sc_token_cache[i].volumeId[0] = '\0';
+                sc_token_cache[i].token[0] = '\0';
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&sc_token_mutex);
+
+    EUCA_FREE(evicted);
+}
+
 //!
 //! Take the token plaintext and redact it to: '*********aaavds'
 //! Replaces all but the last 4 chars with '*'. Will return failure
@@ -134,7 +134,7 @@ typedef struct ebs_volume_data {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-int init_ebs_utils();
+int init_ebs_utils(int sc_request_timeout_sec, int use_sc_pool);
 char *get_volume_local_device(const char *connection_string);
 int deserialize_volume(char *volume_string, ebs_volume_data ** dest);
 int serialize_volume(ebs_volume_data * vol_data, char **dest);
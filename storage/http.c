@@ -86,15 +86,20 @@
 #include <sys/stat.h>                  // stat
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <sys/select.h>
+#include <pthread.h>
+#include <openssl/evp.h>               // EVP_Digest, EVP_EncodeBlock
 
 #include <eucalyptus.h>
 #include <log.h>
 #include "misc.h"
+#include <euca_string.h>
 
 #ifndef _UNIT_TEST
 // http_ functions aren't part of the unit test
 #include <config.h>
 #include "http.h"
+#include "diskutil.h"                  // diskutil_drop_behind
 #endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
@@ -108,6 +113,21 @@
 #define FIRST_TIMEOUT                              4    //!< in seconds, goes in powers of two afterwards
 #define MAX_TIMEOUT                              300    //!< in seconds, the cap for growing timeout values
 #define STRSIZE                                  245    //!< for short strings: files, hosts, URLs
+#define RANGES_MIN_BYTES             (256LL * 1048576)  //!< objects smaller than this are not worth splitting into ranges
+#define RANGES_MAX_STREAMS                        16    //!< cap on the ranges downloaded at once
+#define PARTS_MIN_BYTES              (5LL * 1048576)    //!< smallest part an S3-style multipart upload takes
+#define PARTS_MAX_COUNT                        10000    //!< most parts an S3-style multipart upload takes
+#define PARTS_MAX_STREAMS                         16    //!< cap on the parts uploaded at once
+#define PARTS_RESPONSE_BYTES                   16384    //!< of the responses to the initiate and complete requests
+#define CHUNK_MIN_BYTES                (256 * 1024)     //!< no content-defined chunk boundary is looked for before this many bytes
+#define CHUNK_AVG_BYTES                    1048576      //!< chunk size the boundary masks aim for
+#define CHUNK_MAX_BYTES              (4 * 1048576)      //!< chunks are cut here if no boundary turned up
+#define CHUNK_MASK_SMALL      0xFFFFFC0000000000ULL     //!< 22 bits, makes boundaries rare before CHUNK_AVG_BYTES
+#define CHUNK_MASK_LARGE      0xFFFFC00000000000ULL     //!< 18 bits, makes boundaries common after CHUNK_AVG_BYTES
+#define CHUNK_GEAR_SEED       0x6575636163686b73ULL     //!< seeds the gear table, so every host cuts the same chunks
+#define CHUNK_HASH_LEN                            65    //!< hex SHA-256 of a chunk, with the NUL
+#define CHUNKS_MAGIC                 "euca-chunks 1"    //!< first line of a chunk manifest
+#define CHUNKS_DIR                         "chunks"     //!< where the chunks live, next to the manifest
 #endif /* ! _UNIT_TEST */
 #define RANDOM_DELAY_PERCENT                    0.01    //!< 1% of current timeout determines max delay duration
 
@@ -142,11 +162,83 @@ struct write_request {
     FILE *fp;                          //!< output file pointer to be used by curl WRITERs
     long long total_wrote;             //!< bytes written during the operation
     long long total_calls;             //!< write calls made during the operation
+    char *etag;                        //!< OPTIONAL buffer for the ETag of the response
+    int etag_size;                     //!< size of the etag buffer
+    char *last_modified;               //!< OPTIONAL buffer for the Last-Modified of the response
+    int last_modified_size;            //!< size of the last_modified buffer
+    EVP_MD_CTX *digest;                //!< OPTIONAL running digest of what is written
+    boolean accepts_ranges;            //!< set if the response says the server takes Range requests
 #if defined (CAN_GZIP)
     z_stream strm;                     //!< stream struct used by zlib
     int ret;                           //!< return value of last inflate() call
 #endif                                 /* CAN_GZIP */
 };
+
+//! One range of an object downloaded by http_get_ranges()
+struct range_request {
+    int fd;                            //!< output file, written at the offsets of the range
+    long long pos;                     //!< next byte of the range to download
+    long long end;                     //!< last byte of the range
+    int attempts;                      //!< attempts that failed so far
+    time_t not_before;                 //!< when the next attempt may start
+    CURL *curl;                        //!< handle of the attempt in progress, if any
+    char error_msg[CURL_ERROR_SIZE];
+};
+
+//! One part of a file uploaded by http_put_parts()
+struct part_request {
+    int number;                        //!< of the part, from 1
+    long long offset;                  //!< where the part starts in the file
+    long long size;                    //!< bytes in the part
+    long long sent;                    //!< bytes of the part handed to curl by the current attempt
+    char *buf;                         //!< content of the part, only while it is being uploaded
+    char md5[32];                      //!< base64 MD5 of the part, sent as Content-MD5, or empty
+    char etag[128];                    //!< ETag of the uploaded part, for the complete request
+    boolean done;                      //!< set once the server took the part
+    int attempts;                      //!< attempts that failed so far
+    time_t not_before;                 //!< when the next attempt may start
+    CURL *curl;                        //!< handle of the attempt in progress, if any
+    struct curl_slist *headers;        //!< of the attempt in progress
+    struct write_request head;         //!< catches the ETag of the response
+    char error_msg[CURL_ERROR_SIZE];
+};
+
+//! Response of a request that is kept in memory
+struct buffer_request {
+    char *buf;
+    size_t len;                        //!< bytes in buf, which is kept NUL-terminated
+    size_t size;                       //!< of buf
+};
+
+//! One chunk of a chunk manifest, as cut by chunk_walk()
+struct chunk_entry {
+    long long offset;                  //!< where the chunk starts in the file
+    long long size;                    //!< bytes in the chunk
+    char hash[CHUNK_HASH_LEN];         //!< hex SHA-256 of the content, which also names the chunk on the server
+    boolean have;                      //!< set once the chunk is in the output file
+};
+
+//! What the chunk_walk() callbacks of http_put_chunks() and http_get_chunks() work on
+struct chunk_manifest {
+    long long size;                    //!< of the file
+    int count;                         //!< chunks in the manifest
+    int alloc;                         //!< entries allocated in chunks
+    struct chunk_entry *chunks;
+    struct chunk_entry **by_hash;      //!< chunks sorted by hash, for finding the ones a local file has
+    int missing;                       //!< chunks that are not in the output file yet
+    int fd;                            //!< output file, when downloading
+    char *text;                        //!< manifest being put together, when uploading
+    size_t text_len;
+    size_t text_size;
+    const char *base;                  //!< URL the chunk names are appended to
+    const char *userpwd;               //!< the login and password, or an empty string
+    long long moved_bytes;             //!< bytes sent or downloaded
+    long long kept_bytes;              //!< bytes the server or the local files had already
+    int moved;                         //!< chunks sent or downloaded
+};
+
+//! Callback of chunk_walk(), which stops the walk by returning anything other than EUCA_OK
+typedef int (*chunk_fn) (long long offset, const unsigned char *buf, long long len, const char *hash, void *ctx);
 #endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
@@ -171,6 +263,8 @@ struct write_request {
 
 #ifndef _UNIT_TEST
 static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have already initialize libcurl
+static unsigned long long chunk_gear[256];  //!< random value of each byte, for the rolling hash that cuts chunks
+static pthread_once_t chunk_gear_once = PTHREAD_ONCE_INIT;
 #endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
@@ -181,6 +275,21 @@ static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have
 
 static size_t read_data(char *buffer, size_t size, size_t nitems, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_range(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t read_part(char *buffer, size_t size, size_t nitems, void *params);
+static size_t write_buffer(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_discard(void *buffer, size_t size, size_t nmemb, void *params);
+static int parts_request(const char *url, const char *query, const char *method, const char *body, const char *userpwd, char *response, int response_size);
+static void chunk_gear_init(void);
+static long long chunk_cut(const unsigned char *buf, long long len);
+static void chunk_hash(const unsigned char *buf, long long len, char *hash);
+static int chunk_walk(int fd, chunk_fn fn, void *ctx);
+static int chunk_request(const char *url, const char *method, const char *userpwd, const char *data, long long data_len, struct buffer_request *resp, long *httpcode);
+static int chunk_put(long long offset, const unsigned char *buf, long long len, const char *hash, void *ctx);
+static int chunk_reuse(long long offset, const unsigned char *buf, long long len, const char *hash, void *ctx);
+static int chunk_compare(const void *a, const void *b);
+static int chunk_manifest_parse(const char *text, struct chunk_manifest *m);
 static char hch_to_int(char ch);
 static char int_to_hch(char i);
 
@@ -418,10 +527,74 @@ static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params)
     wrote = fwrite(buffer, size, nmemb, fp);
     ((struct write_request *)params)->total_wrote += wrote;
     ((struct write_request *)params)->total_calls++;
+    if (((struct write_request *)params)->digest)
+        EVP_DigestUpdate(((struct write_request *)params)->digest, buffer, (wrote * size));
 
     return (wrote);
 }
 
+//!
+//! libcurl header handler, which picks out the ETag and the Last-Modified of the response
+//!
+//! @param[in] buffer one header line, not NULL-terminated
+//! @param[in] size
+//! @param[in] nmemb
+//! @param[in] params a transparent pointer to the libcurl write_request structure.
+//!
+//! @return The number of bytes handled
+//!
+static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    struct write_request *req = params;
+    size_t len = size * nmemb;
+    const char *val = buffer;
+
+    if ((len > 20) && !strncasecmp(buffer, "Accept-Ranges: bytes", 20))
+        req->accepts_ranges = TRUE;
+    if ((req->etag != NULL) && (len > 5) && !strncasecmp(buffer, "ETag:", 5)) {
+        for (val += 5, len -= 5; (len > 0) && isspace(*val); val++, len--) ;
+        while ((len > 0) && isspace(val[len - 1]))
+            len--;
+        if (len < req->etag_size) {
+            memcpy(req->etag, val, len);
+            req->etag[len] = '\0';
+        }
+    } else if ((req->last_modified != NULL) && (len > 14) && !strncasecmp(buffer, "Last-Modified:", 14)) {
+        for (val += 14, len -= 14; (len > 0) && isspace(*val); val++, len--) ;
+        while ((len > 0) && isspace(val[len - 1]))
+            len--;
+        if (len < req->last_modified_size) {
+            memcpy(req->last_modified, val, len);
+            req->last_modified[len] = '\0';
+        }
+    }
+    return (size * nmemb);
+}
+
+//!
+//! libcurl write handler for one range of an object, which writes at the offset of the data in the object
+//!
+//! @param[in] buffer
+//! @param[in] size
+//! @param[in] nmemb
+//! @param[in] params a transparent pointer to the range_request structure.
+//!
+//! @return The number of bytes written, which is short of size*nmemb if the write failed or
+//!         the server sent more than the range.
+//!
+static size_t write_range(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    struct range_request *req = params;
+    size_t len = size * nmemb;
+    ssize_t wrote = 0;
+
+    if ((req->pos + (long long)len) > (req->end + 1))
+        return (0);                    // the server is not honoring the range
+    if ((wrote = pwrite(req->fd, buffer, len, req->pos)) > 0)
+        req->pos += wrote;
+    return ((wrote > 0) ? wrote : 0);
+}
+
 //!
 //! Converts hex character to integer
 //!
@@ -610,16 +783,95 @@ int http_get(const char *url, const char *outfile, boolean * bail_flag)
 //! @post On success, the get request has been processed successfully
 //!
 int http_get_timeout(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag)
+{
+    return (http_get_timeout_validated(url, outfile, total_retries, first_timeout, connect_timeout, total_timeout, NULL, bail_flag));
+}
+
+//!
+//! Process an HTTP get request to the given URL with a given timeout, revalidating an earlier
+//! copy of the content with If-None-Match if its ETag is known
+//!
+//! @param[in]  url the request URL
+//! @param[in]  outfile path to the input file to be used by curl WRITERs
+//! @param[in]  total_retries number of retries to execute the get operation
+//! @param[in]  first_timeout number of seconds to wait between attemps. Each attemp will multiply the value by 2.
+//! @param[in]  connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
+//! @param[in]  total_timeout the libcurl total timeout (libcurl option CURLOPT_TIMEOUT)
+//! @param[in]  etag OPTIONAL ETag of the copy the caller has
+//! @param[out] new_etag OPTIONAL buffer for the ETag of the content, set to "" if the server sent none
+//! @param[in]  new_etag_size
+//! @param[out] not_modified OPTIONAL set to TRUE if the server confirmed that the copy with etag is current, in which case nothing is written to outfile
+//! @param[in]  bail_flag
+//!
+//! @return the same as http_get_timeout()
+//!
+//! @see http_get_timeout_validated()
+//!
+int http_get_timeout_etag(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, const char *etag, char *new_etag,
+                          int new_etag_size, boolean * not_modified, boolean * bail_flag)
+{
+    int rc = EUCA_ERROR;
+    http_validator validator = { {0} };
+
+    if (etag && (strlen(etag) < sizeof(validator.etag)))
+        euca_strncpy(validator.etag, etag, sizeof(validator.etag));
+
+    rc = http_get_timeout_validated(url, outfile, total_retries, first_timeout, connect_timeout, total_timeout, &validator, bail_flag);
+    if (not_modified)
+        *not_modified = validator.not_modified;
+    if (new_etag && (new_etag_size > 0))
+        euca_strncpy(new_etag, validator.etag, new_etag_size);
+    return (rc);
+}
+
+//!
+//! Process an HTTP get request to the given URL with a given timeout. If a validator is given,
+//! the request is made conditional on the ETag and the Last-Modified it holds, and the download
+//! fills it in for the new content, including an MD5 of the content computed as it is written,
+//! so the caller can tell whether the content changed without reading it back.
+//!
+//! @param[in]     url the request URL
+//! @param[in]     outfile path to the input file to be used by curl WRITERs
+//! @param[in]     total_retries number of retries to execute the get operation
+//! @param[in]     first_timeout number of seconds to wait between attemps. Each attemp will multiply the value by 2.
+//! @param[in]     connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
+//! @param[in]     total_timeout the libcurl total timeout (libcurl option CURLOPT_TIMEOUT)
+//! @param[in,out] validator OPTIONAL what is known about the copy the caller has. When the server
+//!                confirms that copy is current, validator->not_modified is set and nothing is
+//!                written to outfile.
+//! @param[in]     bail_flag
+//!
+//! @return the same as http_get_timeout()
+//!
+//! @see http_get_timeout()
+//!
+int http_get_timeout_validated(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, http_validator * validator,
+                               boolean * bail_flag)
 {
     int code = EUCA_ERROR;
     int retries = 0;
     int timeout = 0;
     long httpcode = 0L;
+    long long resume_from = 0;
     char error_msg[CURL_ERROR_SIZE] = { 0 };
     FILE *fp = NULL;
     CURL *curl = NULL;
     CURLcode result = CURLE_OK;
+    unsigned char md5[EVP_MAX_MD_SIZE] = { 0 };
+    unsigned int md5_len = 0;
+    char etag[HTTP_VALIDATOR_SIZE] = "";
+    char last_modified[HTTP_VALIDATOR_SIZE] = "";
+    char header[HTTP_VALIDATOR_SIZE + 32] = "";
     struct write_request params = { 0 };
+    struct curl_slist *headers = NULL;
+    EVP_MD_CTX *digest = NULL;
+
+    // what the caller has is what the request is conditional on, the validator then describes the response
+    if (validator) {
+        euca_strncpy(etag, validator->etag, sizeof(etag));
+        euca_strncpy(last_modified, validator->last_modified, sizeof(last_modified));
+        bzero(validator, sizeof(http_validator));
+    }
 
     if (!url || !outfile) {
         LOGERROR("invalid params: outfile=%s, url=%s\n", SP(outfile), SP(url));
@@ -656,6 +908,31 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
     params.fp = fp;
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &params);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+    if (validator) {
+        if ((digest = EVP_MD_CTX_create()) == NULL) {
+            LOGERROR("out of memory for the digest of %s\n", url);
+            curl_easy_cleanup(curl);
+            fclose(fp);
+            return (EUCA_MEMORY_ERROR);
+        }
+        params.digest = digest;
+        params.etag = validator->etag;
+        params.etag_size = sizeof(validator->etag);
+        params.last_modified = validator->last_modified;
+        params.last_modified_size = sizeof(validator->last_modified);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &params);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_header);
+    }
+    if (etag[0]) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", etag);
+        headers = curl_slist_append(headers, header);
+    }
+    if (last_modified[0]) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", last_modified);
+        headers = curl_slist_append(headers, header);
+    }
+    if (headers)
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
     if (connect_timeout > 0) {
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
@@ -683,19 +960,51 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
             euca_nanosleep(random_delay_nanosec);
         }
 
+        // pick up where the previous attempt left off, if it got some of the content, the digest then goes on too
+        if (digest && (resume_from == 0))
+            EVP_DigestInit_ex(digest, EVP_md5(), NULL);
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) resume_from);
+        httpcode = 0L;
         result = curl_easy_perform(curl);   /* do it */
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
         LOGDEBUG("wrote %lld bytes in %lld writes\n", params.total_wrote, params.total_calls);
 
-        if (result) {
+        if ((resume_from > 0) && ((result == CURLE_RANGE_ERROR) || (httpcode == 416L))) {
+            // the server cannot resume, so start over, right away
+            LOGWARN("server cannot resume the download of %s at byte %lld, starting over\n", url, resume_from);
+            resume_from = 0;
+            fseeko(fp, 0L, SEEK_SET);
+            continue;
+        } else if (result) {
             // curl error (connection or transfer failed)
             LOGERROR("%s (%d)\n", error_msg, result);
+            if ((httpcode == 200L) || (httpcode == 206L)) {
+                resume_from += params.total_wrote;  // what was written is content, so keep it
+            } else {
+                resume_from = 0;
+            }
         } else {
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
             //! @TODO pull out response message, too
             switch (httpcode) {
             case 200L:
+            case 206L:                // the rest of the content, after a resumed attempt
                 // all good
                 LOGDEBUG("saved image in %s\n", outfile);
+                if (digest && EVP_DigestFinal_ex(digest, md5, &md5_len)) {
+                    for (unsigned int i = 0; i < md5_len; i++)
+                        sprintf(validator->md5 + 2 * i, "%02x", md5[i]);
+                }
+                code = EUCA_OK;
+                break;
+            case 304L:
+                // only possible with a conditional request, so the copy the caller has is current
+                LOGDEBUG("content of %s has not changed\n", url);
+                if (validator) {
+                    validator->not_modified = TRUE;
+                    euca_strncpy(validator->etag, etag, sizeof(validator->etag));
+                    if (!validator->last_modified[0])
+                        euca_strncpy(validator->last_modified, last_modified, sizeof(validator->last_modified));
+                }
                 code = EUCA_OK;
                 break;
             case 408L:
@@ -728,21 +1037,1193 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
             if (timeout > MAX_TIMEOUT)
                 timeout = MAX_TIMEOUT;
 
-            fseek(fp, 0L, SEEK_SET);   // move the file pointer to the beginning for the retry
+            if (result == CURLE_OK)    // the response was an error, which is not content
+                resume_from = 0;
+            if (resume_from > 0) {
+                LOGINFO("will resume the download of %s at byte %lld\n", url, resume_from);
+            } else if (validator) {
+                validator->etag[0] = validator->last_modified[0] = '\0';
+            }
+            fseeko(fp, resume_from, SEEK_SET); // move the file pointer to where the retry writes
         }
 
         retries--;
     } while ((code != EUCA_OK) && (retries > 0));
+    if ((code == EUCA_OK) && (diskutil_get_io_policy(outfile) & DISKUTIL_IO_POLICY_DONTNEED) && (fflush(fp) == 0))
+        diskutil_drop_behind(fileno(fp), 0, 0);
     fclose(fp);
 
     if (code != EUCA_OK) {
         LOGWARN("removing %s\n", outfile);
         remove(outfile);
     }
+    if (headers)
+        curl_slist_free_all(headers);
+    if (digest)
+        EVP_MD_CTX_destroy(digest);
     curl_easy_cleanup(curl);
     return (code);
 }
 
+//!
+//! Downloads a large object as several byte ranges at once, which helps when a single
+//! connection cannot fill the link. Each range is retried, from where it stopped, on its own.
+//! Objects that are too small, or on servers that do not take Range requests, are downloaded
+//! with http_get().
+//!
+//! @param[in] url the request URL
+//! @param[in] outfile path to the output file
+//! @param[in] streams ranges to download at once
+//! @param[in] bail_flag
+//!
+//! @return The result of http_get() or EUCA_OK on success or the following error codes:
+//!         \li EUCA_ERROR: on failure
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_ACCESS_ERROR: if we fail to access the outfile.
+//!
+//! @see http_get()
+//!
+int http_get_ranges(const char *url, const char *outfile, int streams, boolean * bail_flag)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    int active = 0;
+    int running = 0;
+    int left = 0;
+    int max_fd = -1;
+    int ranges_done = 0;
+    boolean do_fall_back = FALSE;
+    long httpcode = 0L;
+    long timeout_ms = 0;
+    double length = 0.0;
+    long long size = 0;
+    long long range_bytes = 0;
+    time_t now = 0;
+    char range[64] = "";
+    fd_set fd_read;
+    fd_set fd_write;
+    fd_set fd_exc;
+    struct timeval tv = { 0 };
+    struct write_request head = { 0 };
+    struct range_request *ranges = NULL;
+    struct range_request *r = NULL;
+    CURL *curl = NULL;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+
+    if (!url || !outfile || (strncasecmp(url, "http://", 7) != 0)) {
+        LOGERROR("invalid params: outfile=%s, url=%s\n", SP(outfile), SP(url));
+        return (EUCA_INVALID_ERROR);
+    }
+    if (streams > RANGES_MAX_STREAMS)
+        streams = RANGES_MAX_STREAMS;
+    if (streams < 2)
+        return (http_get(url, outfile, bail_flag));
+
+    // find out how big the object is and whether the server takes ranges
+    if ((curl = curl_easy_init()) == NULL) {
+        LOGERROR("could not initialize libcurl\n");
+        return (EUCA_ERROR);
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &head);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_header);
+    if ((curl_easy_perform(curl) == CURLE_OK) && (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode) == CURLE_OK) && (httpcode == 200L)
+        && (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length) == CURLE_OK)) {
+        size = (long long)length;
+    }
+    curl_easy_cleanup(curl);
+    if (!head.accepts_ranges || (size < RANGES_MIN_BYTES)) {
+        LOGDEBUG("downloading %s (%lld bytes) in one piece\n", url, size);
+        return (http_get(url, outfile, bail_flag));
+    }
+
+    if ((fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+        LOGERROR("failed to open %s for writing\n", outfile);
+        return (EUCA_ACCESS_ERROR);
+    }
+    if (((ranges = EUCA_ZALLOC(streams, sizeof(struct range_request))) == NULL) || ((multi = curl_multi_init()) == NULL)) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(ranges);
+        close(fd);
+        remove(outfile);
+        return (EUCA_ERROR);
+    }
+
+    range_bytes = (size + streams - 1) / streams;
+    for (int i = 0; i < streams; i++) {
+        ranges[i].fd = fd;
+        ranges[i].pos = i * range_bytes;
+        ranges[i].end = ((i + 1) * range_bytes < size) ? ((i + 1) * range_bytes - 1) : (size - 1);
+    }
+    LOGINFO("downloading %s (%lld bytes) in %d ranges\n", url, size, streams);
+
+    while ((ret == EUCA_OK) && (ranges_done < streams)) {
+        if ((bail_flag != NULL) && (*bail_flag == TRUE)) {
+            LOGWARN("bailing on the download for %s\n", url);
+            ret = EUCA_ERROR;
+            break;
+        }
+
+        // (re)start the ranges that are not downloading and not backing off
+        now = time(NULL);
+        for (int i = 0; (i < streams) && (ret == EUCA_OK); i++) {
+            r = &(ranges[i]);
+            if (r->curl || (r->pos > r->end) || (r->not_before > now))
+                continue;
+            if ((r->curl = curl_easy_init()) == NULL) {
+                LOGERROR("could not initialize libcurl\n");
+                ret = EUCA_ERROR;
+                break;
+            }
+            snprintf(range, sizeof(range), "%lld-%lld", r->pos, r->end);
+            curl_easy_setopt(r->curl, CURLOPT_URL, url);
+            curl_easy_setopt(r->curl, CURLOPT_HTTPGET, 1L);
+            curl_easy_setopt(r->curl, CURLOPT_RANGE, range);
+            curl_easy_setopt(r->curl, CURLOPT_PRIVATE, r);
+            curl_easy_setopt(r->curl, CURLOPT_ERRORBUFFER, r->error_msg);
+            curl_easy_setopt(r->curl, CURLOPT_WRITEDATA, r);
+            curl_easy_setopt(r->curl, CURLOPT_WRITEFUNCTION, write_range);
+            curl_easy_setopt(r->curl, CURLOPT_LOW_SPEED_LIMIT, 360L);
+            curl_easy_setopt(r->curl, CURLOPT_LOW_SPEED_TIME, 10L);
+            curl_multi_add_handle(multi, r->curl);
+            active++;
+        }
+        if (ret != EUCA_OK)
+            break;
+        if (active == 0) {             // all ranges that are left are backing off
+            sleep(1);
+            continue;
+        }
+
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&r);
+            httpcode = 0L;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpcode);
+            if ((msg->data.result == CURLE_OK) && (httpcode == 206L) && (r->pos > r->end)) {
+                ranges_done++;
+            } else if (httpcode == 200L) {
+                LOGWARN("server ignored the range requested from %s\n", url);
+                do_fall_back = TRUE;
+                ret = EUCA_ERROR;
+            } else if ((httpcode != 206L) && (httpcode != 408L) && (msg->data.result == CURLE_OK)) {
+                LOGERROR("server responded with HTTP code %ld for a range of %s\n", httpcode, url);
+                ret = EUCA_ERROR;
+            } else if (++(r->attempts) >= TOTAL_RETRIES) {
+                LOGERROR("gave up on bytes %lld-%lld of %s: %s (%d, HTTP %ld)\n", r->pos, r->end, url, r->error_msg, msg->data.result, httpcode);
+                ret = EUCA_ERROR;
+            } else {
+                int backoff = FIRST_TIMEOUT << ((r->attempts < 8) ? (r->attempts - 1) : 7);
+                if (backoff > MAX_TIMEOUT)
+                    backoff = MAX_TIMEOUT;
+                LOGWARN("download of bytes %lld-%lld of %s failed: %s (%d, HTTP %ld), resuming in %d sec\n", r->pos, r->end, url, r->error_msg,
+                        msg->data.result, httpcode, backoff);
+                r->not_before = time(NULL) + backoff;
+            }
+            curl_multi_remove_handle(multi, r->curl);
+            curl_easy_cleanup(r->curl);
+            r->curl = NULL;
+            active--;
+        }
+
+        if ((ret == EUCA_OK) && (running > 0)) {
+            FD_ZERO(&fd_read);
+            FD_ZERO(&fd_write);
+            FD_ZERO(&fd_exc);
+            max_fd = -1;
+            timeout_ms = -1;
+            curl_multi_fdset(multi, &fd_read, &fd_write, &fd_exc, &max_fd);
+            curl_multi_timeout(multi, &timeout_ms);
+            if ((timeout_ms < 0) || (timeout_ms > 1000))
+                timeout_ms = 1000;
+            tv.tv_sec = timeout_ms / 1000;
+            tv.tv_usec = (timeout_ms % 1000) * 1000;
+            if (max_fd == -1) {
+                usleep(100000);
+            } else {
+                select(max_fd + 1, &fd_read, &fd_write, &fd_exc, &tv);
+            }
+        }
+    }
+
+    for (int i = 0; i < streams; i++) {
+        if (ranges[i].curl) {
+            curl_multi_remove_handle(multi, ranges[i].curl);
+            curl_easy_cleanup(ranges[i].curl);
+        }
+    }
+    curl_multi_cleanup(multi);
+    EUCA_FREE(ranges);
+    if ((ret == EUCA_OK) && !do_fall_back && (diskutil_get_io_policy(outfile) & DISKUTIL_IO_POLICY_DONTNEED))
+        diskutil_drop_behind(fd, 0, 0);
+    if (close(fd) != 0)
+        ret = EUCA_ERROR;
+
+    if (do_fall_back) {
+        return (http_get(url, outfile, bail_flag));
+    } else if (ret != EUCA_OK) {
+        LOGWARN("removing %s\n", outfile);
+        remove(outfile);
+    } else {
+        LOGDEBUG("saved %lld bytes of %s in %s\n", size, url, outfile);
+    }
+    return (ret);
+}
+
+//!
+//! Uploads a large file as the parts of an S3-style multipart upload: the upload is
+//! initiated, up to 'streams' parts of 'part_bytes' are read from the file and sent
+//! at once, each part is retried on its own, and the upload is completed with the
+//! ETags of all parts (or aborted on failure). Only the parts being uploaded are held
+//! in memory. With 'checksum', each part is sent with its Content-MD5, computed while
+//! the other parts are on the wire, so that the server rejects any that got damaged.
+//! Files no bigger than a part, and servers that do not take multipart uploads, get
+//! a single http_put().
+//!
+//! @param[in] file_path path to the file to upload
+//! @param[in] url the request URL
+//! @param[in] login the login for the request (optional)
+//! @param[in] password the password for the request (optional)
+//! @param[in] part_bytes size of the parts, raised as needed to the minimum and to fit the maximum number of parts
+//! @param[in] streams parts uploaded at once
+//! @param[in] checksum set to TRUE to send the MD5 of each part
+//!
+//! @return The result of http_put() or EUCA_OK on success or the following error codes:
+//!         \li EUCA_ERROR: on failure
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_ACCESS_ERROR: if we fail to access file_path
+//!
+//! @see http_put()
+//!
+int http_put_parts(const char *file_path, const char *url, const char *login, const char *password, long long part_bytes, int streams, boolean checksum)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    int nparts = 0;
+    int loaded = 0;
+    int active = 0;
+    int running = 0;
+    int left = 0;
+    int max_fd = -1;
+    int parts_done = 0;
+    int next = 0;
+    long httpcode = 0L;
+    long timeout_ms = 0;
+    size_t body_size = 0;
+    size_t body_len = 0;
+    time_t now = 0;
+    char *ptr = NULL;
+    char *body = NULL;
+    char query[640] = "";
+    char upload_id[512] = "";
+    char userpwd[STRSIZE] = "";
+    char header[64] = "";
+    char response[PARTS_RESPONSE_BYTES] = "";
+    unsigned char digest[EVP_MAX_MD_SIZE] = { 0 };
+    unsigned int digest_len = 0;
+    fd_set fd_read;
+    fd_set fd_write;
+    fd_set fd_exc;
+    struct timeval tv = { 0 };
+    struct stat64 mystat = { 0 };
+    struct part_request *parts = NULL;
+    struct part_request *r = NULL;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+
+    if (!file_path || !url) {
+        LOGERROR("invalid params: file_path=%s, url=%s\n", SP(file_path), SP(url));
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (stat64(file_path, &mystat) || !S_ISREG(mystat.st_mode)) {
+        LOGERROR("failed to stat %s or it is not a regular file\n", file_path);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    if (streams > PARTS_MAX_STREAMS)
+        streams = PARTS_MAX_STREAMS;
+    if (streams < 1)
+        streams = 1;
+    if (part_bytes < PARTS_MIN_BYTES)
+        part_bytes = PARTS_MIN_BYTES;
+    if (((mystat.st_size + part_bytes - 1) / part_bytes) > PARTS_MAX_COUNT)
+        part_bytes = (mystat.st_size + PARTS_MAX_COUNT - 1) / PARTS_MAX_COUNT;
+    if (mystat.st_size <= part_bytes) {
+        LOGDEBUG("uploading %s (%lld bytes) in one piece\n", file_path, (long long)mystat.st_size);
+        return (http_put(file_path, url, login, password));
+    }
+
+    if (!curl_initialized) {
+        curl_global_init(CURL_GLOBAL_SSL);
+        curl_initialized = TRUE;
+    }
+    if ((login != NULL) && (password != NULL))
+        snprintf(userpwd, sizeof(userpwd), "%s:%s", login, password);
+
+    // servers that do not do multipart uploads turn down the initiate request
+    if ((parts_request(url, "uploads", "POST", "", userpwd, response, sizeof(response)) != EUCA_OK)
+        || ((ptr = strstr(response, "<UploadId>")) == NULL) || (sscanf(ptr + 10, "%511[^<]", upload_id) != 1)) {
+        LOGINFO("server did not take a multipart upload for %s, uploading in one piece\n", url);
+        return (http_put(file_path, url, login, password));
+    }
+
+    nparts = (mystat.st_size + part_bytes - 1) / part_bytes;
+    if (((fd = open(file_path, O_RDONLY)) == -1) || ((parts = EUCA_ZALLOC(nparts, sizeof(struct part_request))) == NULL) || ((multi = curl_multi_init()) == NULL)) {
+        LOGERROR("failed to open %s or out of memory\n", file_path);
+        ret = EUCA_ERROR;
+        goto abort;
+    }
+
+    for (int i = 0; i < nparts; i++) {
+        parts[i].number = i + 1;
+        parts[i].offset = i * part_bytes;
+        parts[i].size = ((i + 1) * part_bytes < mystat.st_size) ? (part_bytes) : (mystat.st_size - i * part_bytes);
+        parts[i].head.etag = parts[i].etag;
+        parts[i].head.etag_size = sizeof(parts[i].etag);
+    }
+    LOGINFO("uploading %s (%lld bytes) to %s in %d parts of %lld bytes, %d at once\n", file_path, (long long)mystat.st_size, url, nparts, part_bytes, streams);
+
+    while ((ret == EUCA_OK) && (parts_done < nparts)) {
+        // read the next parts into memory, as long as fewer than 'streams' are held
+        while ((loaded < streams) && (next < nparts)) {
+            r = &(parts[next]);
+            if ((r->buf = EUCA_ALLOC(r->size, sizeof(char))) == NULL) {
+                LOGERROR("out of memory\n");
+                ret = EUCA_ERROR;
+                break;
+            }
+            if (pread(fd, r->buf, r->size, r->offset) != r->size) {
+                LOGERROR("failed to read part %d of %s\n", r->number, file_path);
+                ret = EUCA_ERROR;
+                break;
+            }
+            if (checksum) {
+                EVP_Digest(r->buf, r->size, digest, &digest_len, EVP_md5(), NULL);
+                EVP_EncodeBlock((unsigned char *)r->md5, digest, digest_len);
+            }
+            loaded++;
+            next++;
+        }
+        if (ret != EUCA_OK)
+            break;
+
+        // (re)start the parts that are held and not uploading nor backing off
+        now = time(NULL);
+        for (int i = 0; (i < next) && (ret == EUCA_OK); i++) {
+            r = &(parts[i]);
+            if (r->done || r->curl || (r->not_before > now))
+                continue;
+            if ((r->curl = curl_easy_init()) == NULL) {
+                LOGERROR("could not initialize libcurl\n");
+                ret = EUCA_ERROR;
+                break;
+            }
+            snprintf(query, sizeof(query), "partNumber=%d&uploadId=%s", r->number, upload_id);
+            if ((ptr = EUCA_ALLOC(strlen(url) + strlen(query) + 2, sizeof(char))) == NULL) {
+                LOGERROR("out of memory\n");
+                ret = EUCA_ERROR;
+                break;
+            }
+            sprintf(ptr, "%s%c%s", url, (strchr(url, '?') ? '&' : '?'), query);
+            curl_easy_setopt(r->curl, CURLOPT_URL, ptr);   // libcurl keeps a copy
+            EUCA_FREE(ptr);
+            if (strlen(r->md5)) {
+                snprintf(header, sizeof(header), "Content-MD5: %s", r->md5);
+                r->headers = curl_slist_append(NULL, header);
+                curl_easy_setopt(r->curl, CURLOPT_HTTPHEADER, r->headers);
+            }
+            r->sent = 0;
+            r->etag[0] = '\0';
+            curl_easy_setopt(r->curl, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(r->curl, CURLOPT_INFILESIZE_LARGE, ((curl_off_t) r->size));
+            curl_easy_setopt(r->curl, CURLOPT_READDATA, r);
+            curl_easy_setopt(r->curl, CURLOPT_READFUNCTION, read_part);
+            curl_easy_setopt(r->curl, CURLOPT_HEADERDATA, &(r->head));
+            curl_easy_setopt(r->curl, CURLOPT_HEADERFUNCTION, write_header);
+            curl_easy_setopt(r->curl, CURLOPT_WRITEFUNCTION, write_discard);
+            curl_easy_setopt(r->curl, CURLOPT_PRIVATE, r);
+            curl_easy_setopt(r->curl, CURLOPT_ERRORBUFFER, r->error_msg);
+            curl_easy_setopt(r->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(r->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+            curl_easy_setopt(r->curl, CURLOPT_LOW_SPEED_LIMIT, 360L);
+            curl_easy_setopt(r->curl, CURLOPT_LOW_SPEED_TIME, 10L);
+            if (strlen(userpwd))
+                curl_easy_setopt(r->curl, CURLOPT_USERPWD, userpwd);
+            curl_multi_add_handle(multi, r->curl);
+            active++;
+        }
+        if (ret != EUCA_OK)
+            break;
+        if (active == 0) {             // all parts that are held are backing off
+            sleep(1);
+            continue;
+        }
+
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&r);
+            httpcode = 0L;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpcode);
+            if ((msg->data.result == CURLE_OK) && (httpcode == 200L) && strlen(r->etag)) {
+                r->done = TRUE;
+                EUCA_FREE(r->buf);     // makes room for the next part
+                loaded--;
+                parts_done++;
+                LOGDEBUG("uploaded part %d of %d of %s\n", r->number, nparts, file_path);
+            } else if ((msg->data.result == CURLE_OK) && (httpcode != 408L) && (httpcode != 500L) && (httpcode != 503L) && (httpcode != 200L)) {
+                LOGERROR("server responded with HTTP code %ld for part %d of %s\n", httpcode, r->number, url);
+                ret = EUCA_ERROR;
+            } else if (++(r->attempts) >= TOTAL_RETRIES) {
+                LOGERROR("gave up on part %d of %s: %s (%d, HTTP %ld)\n", r->number, url, r->error_msg, msg->data.result, httpcode);
+                ret = EUCA_ERROR;
+            } else {
+                int backoff = FIRST_TIMEOUT << ((r->attempts < 8) ? (r->attempts - 1) : 7);
+                if (backoff > MAX_TIMEOUT)
+                    backoff = MAX_TIMEOUT;
+                LOGWARN("upload of part %d of %s failed: %s (%d, HTTP %ld), retrying in %d sec\n", r->number, url, r->error_msg, msg->data.result, httpcode, backoff);
+                r->not_before = time(NULL) + backoff;
+            }
+            curl_multi_remove_handle(multi, r->curl);
+            curl_easy_cleanup(r->curl);
+            r->curl = NULL;
+            curl_slist_free_all(r->headers);
+            r->headers = NULL;
+            active--;
+        }
+
+        if ((ret == EUCA_OK) && (running > 0)) {
+            FD_ZERO(&fd_read);
+            FD_ZERO(&fd_write);
+            FD_ZERO(&fd_exc);
+            max_fd = -1;
+            timeout_ms = -1;
+            curl_multi_fdset(multi, &fd_read, &fd_write, &fd_exc, &max_fd);
+            curl_multi_timeout(multi, &timeout_ms);
+            if ((timeout_ms < 0) || (timeout_ms > 1000))
+                timeout_ms = 1000;
+            tv.tv_sec = timeout_ms / 1000;
+            tv.tv_usec = (timeout_ms % 1000) * 1000;
+            if (max_fd == -1) {
+                usleep(100000);
+            } else {
+                select(max_fd + 1, &fd_read, &fd_write, &fd_exc, &tv);
+            }
+        }
+    }
+
+    if (ret == EUCA_OK) {
+        // the ETags are quoted strings already, so they go in as they are
+        body_size = 64 + nparts * (64 + sizeof(parts[0].etag));
+        if ((body = EUCA_ALLOC(body_size, sizeof(char))) == NULL) {
+            LOGERROR("out of memory\n");
+            ret = EUCA_ERROR;
+        } else {
+            body_len = snprintf(body, body_size, "<CompleteMultipartUpload>");
+            for (int i = 0; i < nparts; i++) {
+                body_len += snprintf(body + body_len, body_size - body_len, "<Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>", parts[i].number, parts[i].etag);
+            }
+            snprintf(body + body_len, body_size - body_len, "</CompleteMultipartUpload>");
+
+            snprintf(query, sizeof(query), "uploadId=%s", upload_id);
+            if ((parts_request(url, query, "POST", body, userpwd, response, sizeof(response)) != EUCA_OK) || strstr(response, "<Error>")) {
+                LOGERROR("failed to complete the multipart upload of %s to %s\n", file_path, url);
+                ret = EUCA_ERROR;
+            }
+            EUCA_FREE(body);
+        }
+    }
+
+abort:
+    for (int i = 0; parts && (i < nparts); i++) {
+        if (parts[i].curl) {
+            curl_multi_remove_handle(multi, parts[i].curl);
+            curl_easy_cleanup(parts[i].curl);
+        }
+        curl_slist_free_all(parts[i].headers);
+        EUCA_FREE(parts[i].buf);
+    }
+    if (multi)
+        curl_multi_cleanup(multi);
+    EUCA_FREE(parts);
+    if (fd >= 0)
+        close(fd);
+
+    if (ret != EUCA_OK) {
+        // so the server does not keep the parts it got around
+        snprintf(query, sizeof(query), "uploadId=%s", upload_id);
+        if (parts_request(url, query, "DELETE", NULL, userpwd, response, sizeof(response)) != EUCA_OK)
+            LOGWARN("failed to abort the multipart upload to %s\n", url);
+    } else {
+        LOGDEBUG("uploaded %lld bytes of %s to %s\n", (long long)mystat.st_size, file_path, url);
+    }
+    return (ret);
+}
+
+//!
+//! Libcurl read callback handler that sends a part held in memory
+//!
+//! @param[out] buffer where libcurl wants the data
+//! @param[in]  size the size of each item
+//! @param[in]  nitems the number of items that fit in the buffer
+//! @param[in]  params a transparent pointer to the part_request structure
+//!
+//! @return The number of bytes handed over, 0 at the end of the part
+//!
+static size_t read_part(char *buffer, size_t size, size_t nitems, void *params)
+{
+    struct part_request *r = params;
+    size_t len = size * nitems;
+
+    if (len > (r->size - r->sent))
+        len = r->size - r->sent;
+    memcpy(buffer, r->buf + r->sent, len);
+    r->sent += len;
+    return (len);
+}
+
+//!
+//! Libcurl write callback handler that keeps the response in memory, truncated to the buffer
+//!
+//! @param[in] buffer the data received
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params a transparent pointer to the buffer_request structure
+//!
+//! @return The number of bytes taken
+//!
+static size_t write_buffer(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    struct buffer_request *req = params;
+    size_t len = size * nmemb;
+    size_t room = req->size - req->len - 1;
+
+    memcpy(req->buf + req->len, buffer, ((len < room) ? len : room));
+    req->len += ((len < room) ? len : room);
+    req->buf[req->len] = '\0';
+    return (size * nmemb);
+}
+
+//!
+//! Libcurl write callback handler for responses that do not matter beyond their HTTP code
+//!
+//! @param[in] buffer the data received
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params unused
+//!
+//! @return The number of bytes taken
+//!
+static size_t write_discard(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    return (size * nmemb);
+}
+
+//!
+//! Sends one of the requests of a multipart upload that are not parts (initiate,
+//! complete and abort), retrying it on connection problems
+//!
+//! @param[in]  url the URL of the object
+//! @param[in]  query added to the URL
+//! @param[in]  method POST or DELETE
+//! @param[in]  body of the request, or NULL for none
+//! @param[in]  userpwd the login and password, or an empty string
+//! @param[out] response the start of the body of the response
+//! @param[in]  response_size
+//!
+//! @return EUCA_OK if the server took the request or EUCA_ERROR otherwise
+//!
+static int parts_request(const char *url, const char *query, const char *method, const char *body, const char *userpwd, char *response, int response_size)
+{
+    int tries = 0;
+    int ret = EUCA_ERROR;
+    long httpcode = 0L;
+    char *full_url = NULL;
+    char error_msg[CURL_ERROR_SIZE] = "";
+    struct buffer_request resp = { 0 };
+    CURL *curl = NULL;
+    CURLcode result = CURLE_OK;
+
+    if ((full_url = EUCA_ALLOC(strlen(url) + strlen(query) + 2, sizeof(char))) == NULL)
+        return (EUCA_ERROR);
+    sprintf(full_url, "%s%c%s", url, (strchr(url, '?') ? '&' : '?'), query);
+
+    for (tries = 0; (tries < 3) && (ret != EUCA_OK); tries++) {
+        if (tries)
+            sleep(FIRST_TIMEOUT << (tries - 1));
+        if ((curl = curl_easy_init()) == NULL)
+            break;
+
+        resp.buf = response;
+        resp.size = response_size;
+        resp.len = 0;
+        response[0] = '\0';
+        curl_easy_setopt(curl, CURLOPT_URL, full_url);
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+        if (body)
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_buffer);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_msg);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 360L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 10L);
+        if (strlen(userpwd))
+            curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd);
+
+        if ((result = curl_easy_perform(curl)) != CURLE_OK) {
+            LOGWARN("%s of %s failed: %s (%d)\n", method, full_url, error_msg, result);
+        } else {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
+            if ((httpcode >= 200L) && (httpcode < 300L)) {
+                ret = EUCA_OK;
+            } else {
+                LOGDEBUG("server responded with HTTP code %ld to %s of %s\n", httpcode, method, full_url);
+                if ((httpcode != 500L) && (httpcode != 503L))
+                    tries = 3; // will not retry
+            }
+        }
+        curl_easy_cleanup(curl);
+    }
+
+    EUCA_FREE(full_url);
+    return (ret);
+}
+
+//!
+//! Uploads a file as a manifest of content-defined chunks, sending only the chunks
+//! that the server does not have yet. The chunks are named by their SHA-256 and live
+//! in a 'chunks' directory next to the manifest, so a file that changed in a few
+//! places shares most of its chunks with the earlier uploads of it.
+//!
+//! @param[in] file_path path to the file to upload
+//! @param[in] url where the manifest goes
+//! @param[in] login the login name, or NULL
+//! @param[in] password the password, or NULL
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_ACCESS_ERROR: if the file cannot be read
+//!         \li EUCA_ERROR: on any other error
+//!
+//! @pre The file_path and url parameters must not be NULL
+//!
+int http_put_chunks(const char *file_path, const char *url, const char *login, const char *password)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    long httpcode = 0L;
+    char *ptr = NULL;
+    char *base = NULL;
+    char userpwd[STRSIZE] = "";
+    struct stat64 mystat = { 0 };
+    struct chunk_manifest m = { 0 };
+
+    if (!file_path || !url || ((ptr = strrchr(url, '/')) == NULL)) {
+        LOGERROR("invalid params: file_path=%s, url=%s\n", SP(file_path), SP(url));
+        return (EUCA_INVALID_ERROR);
+    }
+    if (((fd = open(file_path, O_RDONLY)) == -1) || fstat64(fd, &mystat)) {
+        LOGERROR("failed to open %s for reading\n", file_path);
+        if (fd >= 0)
+            close(fd);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    if (!curl_initialized) {
+        curl_global_init(CURL_GLOBAL_SSL);
+        curl_initialized = TRUE;
+    }
+    if ((login != NULL) && (password != NULL))
+        snprintf(userpwd, sizeof(userpwd), "%s:%s", login, password);
+
+    m.text_size = 4096;
+    if (((base = strndup(url, ptr - url)) == NULL) || ((m.text = EUCA_ALLOC(m.text_size, sizeof(char))) == NULL)) {
+        LOGERROR("out of memory\n");
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
+    m.base = base;
+    m.userpwd = userpwd;
+    m.text_len = snprintf(m.text, m.text_size, "%s\nsize %lld\n", CHUNKS_MAGIC, (long long)mystat.st_size);
+
+    LOGINFO("uploading %s (%lld bytes) to %s as chunks\n", file_path, (long long)mystat.st_size, url);
+    if ((ret = chunk_walk(fd, chunk_put, &m)) != EUCA_OK) {
+        LOGERROR("failed to upload the chunks of %s\n", file_path);
+        goto cleanup;
+    }
+
+    // the manifest goes last, so that it never names a chunk the server does not have
+    if ((chunk_request(url, "PUT", userpwd, m.text, m.text_len, NULL, &httpcode) != EUCA_OK) || (httpcode < 200L) || (httpcode >= 300L)) {
+        LOGERROR("failed to upload the chunk manifest to %s (HTTP %ld)\n", url, httpcode);
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
+    LOGINFO("uploaded %d of %d chunks of %s (%lld bytes sent, %lld bytes already on the server)\n", m.moved, m.count, file_path, m.moved_bytes, m.kept_bytes);
+
+cleanup:
+    EUCA_FREE(m.text);
+    EUCA_FREE(base);
+    close(fd);
+    return (ret);
+}
+
+//!
+//! Downloads a file uploaded by http_put_chunks(). The chunks that are in any of the
+//! local files given are copied from them, and only the rest come from the server.
+//!
+//! @param[in] url of the manifest
+//! @param[in] outfile path of the output file
+//! @param[in] reuse_paths local files that may share chunks with the download, like earlier versions of it
+//! @param[in] nreuse number of reuse_paths
+//! @param[in] bail_flag set to TRUE by the caller to give up on the download
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_ACCESS_ERROR: if the output file cannot be written
+//!         \li EUCA_ERROR: on any other error
+//!
+//! @pre The url and outfile parameters must not be NULL
+//!
+int http_get_chunks(const char *url, const char *outfile, const char **reuse_paths, int nreuse, boolean * bail_flag)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    int first = 0;
+    long httpcode = 0L;
+    char *ptr = NULL;
+    char *text = NULL;
+    char *chunk_url = NULL;
+    char hash[CHUNK_HASH_LEN] = "";
+    struct chunk_entry *c = NULL;
+    struct buffer_request resp = { 0 };
+    struct chunk_manifest m = { 0 };
+
+    if (!url || !outfile || ((ptr = strrchr(url, '/')) == NULL)) {
+        LOGERROR("invalid params: outfile=%s, url=%s\n", SP(outfile), SP(url));
+        return (EUCA_INVALID_ERROR);
+    }
+    if ((text = http_get2str(url, bail_flag)) == NULL) {
+        LOGERROR("failed to download the chunk manifest %s\n", url);
+        return (EUCA_ERROR);
+    }
+    ret = chunk_manifest_parse(text, &m);
+    EUCA_FREE(text);
+    if (ret != EUCA_OK) {
+        LOGERROR("%s is not a chunk manifest\n", url);
+        EUCA_FREE(m.chunks);
+        return (EUCA_ERROR);
+    }
+
+    if (((fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) || ftruncate(fd, m.size)) {
+        LOGERROR("failed to open %s for writing\n", outfile);
+        if (fd >= 0)
+            close(fd);
+        EUCA_FREE(m.chunks);
+        return (EUCA_ACCESS_ERROR);
+    }
+    m.fd = fd;
+    m.missing = m.count;
+    if (((m.by_hash = EUCA_ZALLOC(m.count + 1, sizeof(struct chunk_entry *))) == NULL)
+        || ((chunk_url = EUCA_ALLOC(ptr - url + strlen(CHUNKS_DIR) + CHUNK_HASH_LEN + 3, sizeof(char))) == NULL)
+        || ((resp.buf = EUCA_ALLOC(CHUNK_MAX_BYTES + 1, sizeof(char))) == NULL)) {
+        LOGERROR("out of memory\n");
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
+    for (int i = 0; i < m.count; i++)
+        m.by_hash[i] = &(m.chunks[i]);
+    qsort(m.by_hash, m.count, sizeof(struct chunk_entry *), chunk_compare);
+
+    // the local files are cut the same way, so whatever they kept of the image turns up as the same chunks
+    for (int i = 0; (i < nreuse) && (m.missing > 0); i++) {
+        int rfd = open(reuse_paths[i], O_RDONLY);
+        if (rfd == -1) {
+            LOGWARN("failed to open %s to reuse its chunks\n", reuse_paths[i]);
+            continue;
+        }
+        if (((ret = chunk_walk(rfd, chunk_reuse, &m)) != EUCA_OK) && (ret != EUCA_NO_SPACE_ERROR)) {
+            close(rfd);
+            LOGERROR("failed to copy chunks from %s to %s\n", reuse_paths[i], outfile);
+            goto cleanup;
+        }
+        ret = EUCA_OK;
+        close(rfd);
+        LOGDEBUG("%d of %d chunks of %s still missing after %s\n", m.missing, m.count, url, reuse_paths[i]);
+    }
+
+    for (int i = 0; (i < m.count) && (ret == EUCA_OK); i = first) {
+        // chunks that repeat (zeroes, mostly) are downloaded once
+        for (first = i + 1; (first < m.count) && !strcmp(m.by_hash[first]->hash, m.by_hash[i]->hash); first++) ;
+        if (m.by_hash[i]->have)
+            continue;
+        if ((bail_flag != NULL) && (*bail_flag == TRUE)) {
+            LOGWARN("bailing on the download for %s\n", url);
+            ret = EUCA_ERROR;
+            break;
+        }
+
+        c = m.by_hash[i];
+        sprintf(chunk_url, "%.*s/%s/%s", (int)(ptr - url), url, CHUNKS_DIR, c->hash);
+        resp.size = c->size + 1;
+        resp.len = 0;
+        if ((chunk_request(chunk_url, "GET", "", NULL, 0, &resp, &httpcode) != EUCA_OK) || (httpcode != 200L) || (resp.len != c->size)) {
+            LOGERROR("failed to download chunk %s (HTTP %ld, %ld of %lld bytes)\n", chunk_url, httpcode, (long)resp.len, c->size);
+            ret = EUCA_ERROR;
+            break;
+        }
+        chunk_hash((unsigned char *)resp.buf, resp.len, hash);
+        if (strcmp(hash, c->hash)) {
+            LOGERROR("chunk %s does not match its hash\n", chunk_url);
+            ret = EUCA_ERROR;
+            break;
+        }
+        for (int j = i; j < first; j++) {
+            if (pwrite(fd, resp.buf, resp.len, m.by_hash[j]->offset) != resp.len) {
+                LOGERROR("failed to write %s\n", outfile);
+                ret = EUCA_IO_ERROR;
+                break;
+            }
+        }
+        m.moved++;
+        m.moved_bytes += resp.len;
+    }
+
+    if (ret == EUCA_OK)
+        LOGINFO("downloaded %s (%lld bytes) with %d chunks from the server (%lld bytes) and %lld bytes from local files\n", url, m.size, m.moved, m.moved_bytes, m.kept_bytes);
+
+cleanup:
+    EUCA_FREE(resp.buf);
+    EUCA_FREE(chunk_url);
+    EUCA_FREE(m.by_hash);
+    EUCA_FREE(m.chunks);
+    if ((ret == EUCA_OK) && (fd >= 0) && (diskutil_get_io_policy(outfile) & DISKUTIL_IO_POLICY_DONTNEED))
+        diskutil_drop_behind(fd, 0, 0);
+    close(fd);
+    if (ret != EUCA_OK)
+        remove(outfile);
+    return (ret);
+}
+
+//!
+//! Fills the gear table from a fixed seed with splitmix64
+//!
+static void chunk_gear_init(void)
+{
+    unsigned long long x = CHUNK_GEAR_SEED;
+    unsigned long long z = 0;
+
+    for (int i = 0; i < 256; i++) {
+        z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        chunk_gear[i] = z ^ (z >> 31);
+    }
+}
+
+//!
+//! Finds where the chunk at the start of a buffer ends, using a gear rolling hash over
+//! the last 64 bytes with a stricter mask before the average chunk size than after it
+//!
+//! @param[in] buf the data
+//! @param[in] len bytes in buf, at most CHUNK_MAX_BYTES
+//!
+//! @return The length of the chunk
+//!
+static long long chunk_cut(const unsigned char *buf, long long len)
+{
+    long long i = CHUNK_MIN_BYTES;
+    long long normal = (len < CHUNK_AVG_BYTES) ? (len) : (CHUNK_AVG_BYTES);
+    unsigned long long h = 0;
+
+    if (len <= CHUNK_MIN_BYTES)
+        return (len);
+    for (; i < normal; i++) {
+        h = (h << 1) + chunk_gear[buf[i]];
+        if (!(h & CHUNK_MASK_SMALL))
+            return (i + 1);
+    }
+    for (; i < len; i++) {
+        h = (h << 1) + chunk_gear[buf[i]];
+        if (!(h & CHUNK_MASK_LARGE))
+            return (i + 1);
+    }
+    return (len);
+}
+
+//!
+//! Computes the hex SHA-256 of a chunk
+//!
+//! @param[in]  buf the chunk
+//! @param[in]  len bytes in the chunk
+//! @param[out] hash CHUNK_HASH_LEN bytes for the hash
+//!
+static void chunk_hash(const unsigned char *buf, long long len, char *hash)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE] = { 0 };
+    unsigned int digest_len = 0;
+
+    EVP_Digest(buf, len, digest, &digest_len, EVP_sha256(), NULL);
+    for (unsigned int i = 0; i < digest_len; i++)
+        sprintf(hash + 2 * i, "%02x", digest[i]);
+}
+
+//!
+//! Cuts a file into content-defined chunks and hands each one to a callback
+//!
+//! @param[in] fd the file, read from its current position to the end
+//! @param[in] fn the callback
+//! @param[in] ctx passed to the callback
+//!
+//! @return EUCA_OK, EUCA_IO_ERROR if the file cannot be read, or what the callback returned to stop the walk
+//!
+static int chunk_walk(int fd, chunk_fn fn, void *ctx)
+{
+    int ret = EUCA_OK;
+    ssize_t got = 0;
+    long long len = 0;
+    long long have = 0;
+    long long offset = 0;
+    boolean eof = FALSE;
+    char hash[CHUNK_HASH_LEN] = "";
+    unsigned char *buf = NULL;
+
+    pthread_once(&chunk_gear_once, chunk_gear_init);
+    if ((buf = EUCA_ALLOC(CHUNK_MAX_BYTES, sizeof(unsigned char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    while (ret == EUCA_OK) {
+        while (!eof && (have < CHUNK_MAX_BYTES)) {
+            if ((got = read(fd, buf + have, CHUNK_MAX_BYTES - have)) < 0) {
+                ret = EUCA_IO_ERROR;
+                break;
+            }
+            eof = (got == 0);
+            have += got;
+        }
+        if ((ret != EUCA_OK) || (have == 0))
+            break;
+
+        len = chunk_cut(buf, have);
+        chunk_hash(buf, len, hash);
+        ret = fn(offset, buf, len, hash, ctx);
+        offset += len;
+        have -= len;
+        memmove(buf, buf + len, have);
+    }
+
+    EUCA_FREE(buf);
+    return (ret);
+}
+
+//!
+//! Sends one request for a chunk or a manifest, retrying it on connection problems
+//!
+//! @param[in]  url of the chunk or manifest
+//! @param[in]  method HEAD, GET or PUT
+//! @param[in]  userpwd the login and password, or an empty string
+//! @param[in]  data to PUT, or NULL
+//! @param[in]  data_len bytes of data
+//! @param[out] resp where the body of a GET goes, or NULL
+//! @param[out] httpcode of the response
+//!
+//! @return EUCA_OK if the server responded or EUCA_ERROR otherwise
+//!
+static int chunk_request(const char *url, const char *method, const char *userpwd, const char *data, long long data_len, struct buffer_request *resp, long *httpcode)
+{
+    int ret = EUCA_ERROR;
+    char error_msg[CURL_ERROR_SIZE] = "";
+    struct part_request part = { 0 };
+    CURL *curl = NULL;
+    CURLcode result = CURLE_OK;
+
+    *httpcode = 0L;
+    for (int tries = 0; (tries < 3) && (ret != EUCA_OK); tries++) {
+        if (tries)
+            sleep(FIRST_TIMEOUT << (tries - 1));
+        if ((curl = curl_easy_init()) == NULL)
+            break;
+
+        curl_easy_setopt(curl, CURLOPT_URL, url);
+        if (!strcmp(method, "HEAD")) {
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        } else if (!strcmp(method, "PUT")) {
+            part.buf = (char *)data;
+            part.size = data_len;
+            part.sent = 0;
+            curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+            curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, ((curl_off_t) data_len));
+            curl_easy_setopt(curl, CURLOPT_READDATA, &part);
+            curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_part);
+        }
+        if (resp) {
+            resp->len = 0;
+            resp->buf[0] = '\0';
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_buffer);
+        } else {
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_discard);
+        }
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_msg);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 360L);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 10L);
+        if (strlen(userpwd))
+            curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd);
+
+        if ((result = curl_easy_perform(curl)) != CURLE_OK) {
+            LOGWARN("%s of %s failed: %s (%d)\n", method, url, error_msg, result);
+        } else {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, httpcode);
+            if ((*httpcode != 500L) && (*httpcode != 503L))
+                ret = EUCA_OK;
+        }
+        curl_easy_cleanup(curl);
+    }
+    return (ret);
+}
+
+//!
+//! chunk_walk() callback of http_put_chunks(), which sends the chunk unless the server has it
+//! and adds it to the manifest
+//!
+//! @param[in] offset of the chunk in the file
+//! @param[in] buf the chunk
+//! @param[in] len bytes in the chunk
+//! @param[in] hash of the chunk
+//! @param[in] ctx the chunk_manifest
+//!
+//! @return EUCA_OK or EUCA_ERROR to stop the upload
+//!
+static int chunk_put(long long offset, const unsigned char *buf, long long len, const char *hash, void *ctx)
+{
+    long httpcode = 0L;
+    char *ptr = NULL;
+    char url[EUCA_MAX_PATH] = "";
+    struct chunk_manifest *m = ctx;
+
+    snprintf(url, sizeof(url), "%s/%s/%s", m->base, CHUNKS_DIR, hash);
+    if (chunk_request(url, "HEAD", m->userpwd, NULL, 0, NULL, &httpcode) != EUCA_OK)
+        return (EUCA_ERROR);
+    if (httpcode == 200L) {
+        m->kept_bytes += len;
+    } else if ((chunk_request(url, "PUT", m->userpwd, (const char *)buf, len, NULL, &httpcode) != EUCA_OK) || (httpcode < 200L) || (httpcode >= 300L)) {
+        LOGERROR("failed to upload chunk %s (HTTP %ld)\n", url, httpcode);
+        return (EUCA_ERROR);
+    } else {
+        m->moved++;
+        m->moved_bytes += len;
+    }
+
+    if ((m->text_size - m->text_len) < (CHUNK_HASH_LEN + 64)) {
+        if ((ptr = EUCA_REALLOC(m->text, m->text_size * 2, sizeof(char))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        m->text = ptr;
+        m->text_size *= 2;
+    }
+    m->text_len += snprintf(m->text + m->text_len, m->text_size - m->text_len, "chunk %lld %lld %s\n", offset, len, hash);
+    m->count++;
+    return (EUCA_OK);
+}
+
+//!
+//! chunk_walk() callback of http_get_chunks(), which copies the chunk of a local file
+//! to wherever the manifest has it
+//!
+//! @param[in] offset of the chunk in the local file
+//! @param[in] buf the chunk
+//! @param[in] len bytes in the chunk
+//! @param[in] hash of the chunk
+//! @param[in] ctx the chunk_manifest
+//!
+//! @return EUCA_OK, EUCA_NO_SPACE_ERROR to stop the walk once nothing is missing, or EUCA_IO_ERROR
+//!
+static int chunk_reuse(long long offset, const unsigned char *buf, long long len, const char *hash, void *ctx)
+{
+    struct chunk_entry key = { 0 };
+    struct chunk_entry *pkey = &key;
+    struct chunk_entry **found = NULL;
+    struct chunk_manifest *m = ctx;
+
+    euca_strncpy(key.hash, hash, sizeof(key.hash));
+    if ((found = bsearch(&pkey, m->by_hash, m->count, sizeof(struct chunk_entry *), chunk_compare)) == NULL)
+        return (EUCA_OK);
+    while ((found > m->by_hash) && !strcmp((*(found - 1))->hash, hash))
+        found--;
+    for (; (found < (m->by_hash + m->count)) && !strcmp((*found)->hash, hash); found++) {
+        if ((*found)->have || ((*found)->size != len))
+            continue;
+        if (pwrite(m->fd, buf, len, (*found)->offset) != len)
+            return (EUCA_IO_ERROR);
+        (*found)->have = TRUE;
+        m->kept_bytes += len;
+        m->missing--;
+    }
+    return ((m->missing > 0) ? (EUCA_OK) : (EUCA_NO_SPACE_ERROR));
+}
+
+//!
+//! qsort() and bsearch() comparator of chunk_entry pointers, by hash
+//!
+//! @param[in] a pointer to the first chunk_entry pointer
+//! @param[in] b pointer to the second chunk_entry pointer
+//!
+//! @return Same as strcmp()
+//!
+static int chunk_compare(const void *a, const void *b)
+{
+    return (strcmp((*(struct chunk_entry * const *)a)->hash, (*(struct chunk_entry * const *)b)->hash));
+}
+
+//!
+//! Parses a chunk manifest, checking that its chunks cover the file without gaps
+//!
+//! @param[in]  text of the manifest
+//! @param[out] m gets the size and the chunks, which the caller frees
+//!
+//! @return EUCA_OK or EUCA_ERROR if the manifest is not valid
+//!
+static int chunk_manifest_parse(const char *text, struct chunk_manifest *m)
+{
+    int n = 0;
+    long long end = 0;
+    const char *line = text;
+    struct chunk_entry *c = NULL;
+    struct chunk_entry *more = NULL;
+
+    if (strncmp(line, CHUNKS_MAGIC "\n", strlen(CHUNKS_MAGIC) + 1))
+        return (EUCA_ERROR);
+    line += strlen(CHUNKS_MAGIC) + 1;
+    if ((sscanf(line, "size %lld\n%n", &(m->size), &n) != 1) || (n == 0) || (m->size < 0))
+        return (EUCA_ERROR);
+
+    for (line += n; *line != '\0'; line += n) {
+        if (m->count == m->alloc) {
+            m->alloc = (m->alloc) ? (m->alloc * 2) : (256);
+            if ((more = EUCA_REALLOC(m->chunks, m->alloc, sizeof(struct chunk_entry))) == NULL)
+                return (EUCA_ERROR);
+            m->chunks = more;
+        }
+        c = &(m->chunks[m->count]);
+        n = 0;
+        if ((sscanf(line, "chunk %lld %lld %64[0-9a-f]\n%n", &(c->offset), &(c->size), c->hash, &n) != 3) || (n == 0)
+            || (c->offset != end) || (c->size <= 0) || (c->size > CHUNK_MAX_BYTES) || (strlen(c->hash) != (CHUNK_HASH_LEN - 1)))
+            return (EUCA_ERROR);
+        c->have = FALSE;
+        end += c->size;
+        m->count++;
+    }
+    return ((end == m->size) ? (EUCA_OK) : (EUCA_ERROR));
+}
+
 #ifdef _UNIT_TEST
 //!
 //! Main entry point of the application
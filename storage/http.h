@@ -83,6 +83,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define HTTP_VALIDATOR_SIZE                      256    //!< size of the ETag and Last-Modified strings of an http_validator
+#define HTTP_MD5_SIZE                            33     //!< size of the hex MD5 string of an http_validator
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -101,6 +104,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! What is known about a copy of the content of a URL, so that downloading it again can be
+//! made conditional on a change, and what the download found out about the new content
+typedef struct http_validator_t {
+    char etag[HTTP_VALIDATOR_SIZE];    //!< ETag of the copy, "" if not known
+    char last_modified[HTTP_VALIDATOR_SIZE];    //!< Last-Modified of the copy, "" if not known
+    char md5[HTTP_MD5_SIZE];           //!< hex MD5 of the downloaded content, computed as it is written
+    boolean not_modified;              //!< set when the server confirmed that the copy is current and nothing was downloaded
+} http_validator;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -118,7 +130,15 @@ char *url_encode(const char *unencoded);
 char *url_decode(const char *encoded);
 int http_get(const char *url, const char *outfile, boolean * bail_flag);
 int http_get_timeout(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, boolean * bail_flag);
+int http_get_timeout_etag(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, const char *etag, char *new_etag,
+                          int new_etag_size, boolean * not_modified, boolean * bail_flag);
+int http_get_timeout_validated(const char *url, const char *outfile, int total_retries, int first_timeout, int connect_timeout, int total_timeout, http_validator * validator,
+                               boolean * bail_flag);
 char *http_get2str(const char *url, boolean * bail_flag);
+int http_get_ranges(const char *url, const char *outfile, int streams, boolean * bail_flag);
+int http_put_parts(const char *file_path, const char *url, const char *login, const char *password, long long part_bytes, int streams, boolean checksum);
+int http_put_chunks(const char *file_path, const char *url, const char *login, const char *password);
+int http_get_chunks(const char *url, const char *outfile, const char **reuse_paths, int nreuse, boolean * bail_flag);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
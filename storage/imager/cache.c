@@ -35,12 +35,17 @@
 #include <time.h>                      // time
 #include <errno.h>                     // errno
 #include <sys/types.h>                 // *dir, etc
+#include <sys/stat.h>
+#include <sys/file.h>                  // flock
+#include <fcntl.h>                     // open
 #include <limits.h>
 #include <dirent.h>
 
 #include <eucalyptus.h>
 #include <misc.h>
 #include <euca_string.h>
+#include <euca_file.h>
+#include <hashtable.h>
 #include "cache.h"
 #include "imager.h"
 
@@ -51,6 +56,11 @@
 \*----------------------------------------------------------------------------*/
 
 #define EUCA_SIZE_UNLIMITED                      LLONG_MAX
+#define CACHE_INDEX_FILE                         ".index"   //!< list of the cache entries, in the cache directory
+#define CACHE_INDEX_DIRTY                        ".index.dirty" //!< exists while the cache directory is ahead of the index
+#define CACHE_INDEX_LOCK                         ".index.lock"  //!< serializes changes to the cache among imager processes
+#define CACHE_INDEX_HEADER                       "euca-imager-cache-index 1\n"
+#define CACHE_INDEX_SLOTS                        1024   //!< initial capacity of the in-memory index
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -91,6 +101,10 @@
 \*----------------------------------------------------------------------------*/
 
 static disk_item *cache_head = NULL;
+static hashtable *cache_table = NULL;  //!< the entries of the cache_head list, by content path
+static boolean cache_loaded = FALSE;   //!< whether the list reflects the cache directory
+static ino_t cache_index_ino = 0;      //!< inode of the index as this process last read or wrote it
+static int cache_lock_fd = -1;         //!< held by lock_cache()
 static s64 cache_used = 0L;
 static s64 cache_limit = EUCA_SIZE_UNLIMITED;   //!< size limit for cache space
 static char cache_path[EUCA_MAX_PATH] = "./euca-imager-cache.d";  //!< default cache dir
@@ -109,7 +123,15 @@ static boolean cache_was_created = FALSE;
 
 static disk_item *find_in_cache(const char *path) _attribute_wur_;
 static void add_to_cache(disk_item * di);
+static void remove_from_cache(disk_item * di);
+static void clear_cache(void);
+static disk_item *merge_into_cache(const char *id, s64 content_size, s64 total_size, hashtable * seen);
+static void prune_cache(hashtable * seen);
 static void print_cache(void);
+static void mark_cache_index(void);
+static int save_cache_index(void);
+static int load_cache_index(void);
+static void ensure_cache_loaded(void);
 
 static size_t catprintfn(char *buf, const size_t len, const char *format, ...) _attribute_format_(3, 4);
 
@@ -128,23 +150,43 @@ static char *gen_summary(artifacts_spec * spec) _attribute_wur_;
 \*----------------------------------------------------------------------------*/
 
 //!
+//! Serializes the use of the cache directory with the other imager processes sharing it,
+//! which may all change the entries and the index
 //!
-//!
-//! @see unlock_caches()
+//! @see unlock_cache()
 //!
 void lock_cache(void)
 {
+    char path[EUCA_MAX_PATH] = "";
+
+    if (cache_lock_fd >= 0)
+        return;
+
+    snprintf(path, sizeof(path), "%s/%s", cache_path, CACHE_INDEX_LOCK);
+    if ((cache_lock_fd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+        LOGWARN("failed to open cache lock '%s': %s\n", path, strerror(errno));
+        return;
+    }
 
+    if (flock(cache_lock_fd, LOCK_EX) == -1) {
+        LOGWARN("failed to lock the cache '%s': %s\n", path, strerror(errno));
+        close(cache_lock_fd);
+        cache_lock_fd = -1;
+    }
 }
 
 //!
-//!
+//! Lets the other imager processes use the cache directory
 //!
 //! @see lock_cache()
 //!
 void unlock_cache(void)
 {
-
+    if (cache_lock_fd >= 0) {
+        flock(cache_lock_fd, LOCK_UN);
+        close(cache_lock_fd);
+        cache_lock_fd = -1;
+    }
 }
 
 //!
@@ -210,6 +252,9 @@ int set_cache_dir(const char *path)
         return EUCA_ERROR;
     }
 
+    if (strcmp(cache_path, path)) {
+        clear_cache();                 // the entries and the index of another directory
+    }
     euca_strncpy(cache_path, path, EUCA_MAX_PATH);
     return EUCA_OK;
 }
@@ -253,29 +298,23 @@ int clean_cache_dir(blobstore * cache_bs)
 }
 
 //!
-//!
+//! Looks up a cache entry by the path of its content
 //!
 //! @param[in] path
 //!
-//! @return
+//! @return The entry, which stays in the cache, or NULL if there is none
 //!
 //! @pre The path field must not be NULL.
 //!
 static disk_item *find_in_cache(const char *path)
 {
-    disk_item *p = NULL;
-
-    if (path != NULL) {
-        for (p = cache_head; p != NULL; p = p->next) {
-            if (strncmp(p->path, path, EUCA_MAX_PATH) == 0)
-                break;
-        }
-    }
-    return p;
+    if ((path == NULL) || (cache_table == NULL))
+        return NULL;
+    return ((disk_item *) hashtable_get(cache_table, path));
 }
 
 //!
-//!
+//! Adds an entry to the cache, in place of any previous one for the same path
 //!
 //! @param[in] di
 //!
@@ -286,49 +325,290 @@ static disk_item *find_in_cache(const char *path)
 static void add_to_cache(disk_item * di)
 {
     disk_item *p = NULL;
-    disk_item **pp = NULL;
 
     if (di == NULL) {
         LOGFATAL("NULL disk item in add_to_cache()\n");
+        return;
+    }
+
+    if ((cache_table == NULL) && ((cache_table = hashtable_create(CACHE_INDEX_SLOTS)) == NULL)) {
+        LOGFATAL("out of memory for the cache index\n");
+        return;
+    }
+    // if entry is alredy there, the new struct replaces it
+    if (((p = find_in_cache(di->path)) != NULL) && (p != di)) {
+        LOGWARN("refreshing cache entry (%s)\n", di->base);
+        remove_from_cache(p);
+        FREE_DISK_ITEM(p);
+    } else if (p == di) {
+        return;
+    }
+
+    if (hashtable_set(cache_table, di->path, di) != EUCA_OK) {
+        LOGFATAL("out of memory for the cache index\n");
+        return;
+    }
+
+    di->prev = NULL;
+    di->next = cache_head;
+    if (cache_head)
+        cache_head->prev = di;
+    cache_head = di;
+    cache_used += di->total_size;
+}
+
+//!
+//! Takes an entry out of the cache, if it is in it, without freeing it
+//!
+//! @param[in] di
+//!
+static void remove_from_cache(disk_item * di)
+{
+    if ((di == NULL) || (find_in_cache(di->path) != di))
+        return;
+
+    hashtable_remove(cache_table, di->path);
+    if (di->next)
+        di->next->prev = di->prev;
+    if (di->prev) {
+        di->prev->next = di->next;
     } else {
-        di->next = NULL;
-        di->prev = NULL;
+        cache_head = di->next;
+    }
+    di->next = NULL;
+    di->prev = NULL;
+    cache_used -= di->total_size;
+}
+
+//!
+//! Frees all entries of the cache in memory, so that they are read again from the disk
+//!
+static void clear_cache(void)
+{
+    disk_item *d = NULL;
 
-        // run through the LL of cache entries
-        for (pp = &cache_head; *pp != NULL; pp = &((*pp)->next)) {
-            p = *pp;
+    while ((d = cache_head) != NULL) {
+        cache_head = d->next;
+        FREE_DISK_ITEM(d);
+    }
+    hashtable_free(cache_table);
+    cache_table = NULL;
+    cache_used = 0L;
+    cache_loaded = FALSE;
+    cache_index_ino = 0;
+}
 
-            // if entry is alredy there, splice in the new struct into LL
-            if (strncmp(p->base, di->base, EUCA_MAX_PATH) == 0) {
-                LOGWARN("refreshing cache entry (%s)\n", di->base);
-                di->prev = p->prev;
-                di->next = p->next;
+//!
+//! Adds an entry read from the disk to the cache, or updates the entry already there so
+//! that pointers to it held by outputs of this process stay valid
+//!
+//! @param[in] id
+//! @param[in] content_size
+//! @param[in] total_size
+//! @param[in] seen optional table where the entry is recorded, for prune_cache()
+//!
+//! @return The entry or NULL on error
+//!
+static disk_item *merge_into_cache(const char *id, s64 content_size, s64 total_size, hashtable * seen)
+{
+    disk_item *di = NULL;
+    char path[EUCA_MAX_PATH] = "";
 
-                if (di->prev)
-                    di->prev->next = di;
+    snprintf(path, sizeof(path), "%s/%s/content", cache_path, id);
+    if ((di = find_in_cache(path)) != NULL) {
+        cache_used += total_size - di->total_size;
+        di->content_size = content_size;
+        di->total_size = total_size;
+    } else if ((di = alloc_disk_item(id, content_size, total_size, TRUE)) != NULL) {
+        add_to_cache(di);
+    }
 
-                if (di->next)
-                    di->next->prev = di;
+    if ((di != NULL) && (seen != NULL))
+        hashtable_set(seen, di->path, di);
+    return di;
+}
 
-                cache_used -= p->total_size;
-                FREE_DISK_ITEM(p);
-                pp = NULL;
-                break;
-            }
+//!
+//! Takes out of the cache the entries that were not found on the disk. They are not freed,
+//! as an output of this process may still refer to them.
+//!
+//! @param[in] seen the entries found, by merge_into_cache()
+//!
+static void prune_cache(hashtable * seen)
+{
+    disk_item *e = NULL;
+    disk_item *next = NULL;
+
+    for (e = cache_head; e; e = next) {
+        next = e->next;
+        if (hashtable_get(seen, e->path) == NULL) {
+            LOGDEBUG("dropping cache entry %s\n", e->base);
+            remove_from_cache(e);
         }
+    }
+}
 
-        // if entry wasn't in the LL, add it at the end
-        if (p) {
-            // if second or later entry
-            di->prev = p;
-            p->next = di;
+//!
+//! Records that the cache directory is about to change ahead of its index, so that a
+//! crash before save_cache_index() makes the next run rebuild the index with scan_cache()
+//!
+static void mark_cache_index(void)
+{
+    int fd = -1;
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), "%s/%s", cache_path, CACHE_INDEX_DIRTY);
+    if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0) {
+        LOGWARN("failed to mark the cache index as outdated in '%s': %s\n", path, strerror(errno));
+        return;
+    }
+    close(fd);
+}
+
+//!
+//! Writes the entries of the cache to its index, in a new file renamed over the old one so
+//! that the index on disk is always complete, and clears the mark_cache_index() mark
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure, which leaves the mark
+//!
+static int save_cache_index(void)
+{
+    FILE *fp = NULL;
+    disk_item *e = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    char tmp_path[EUCA_MAX_PATH] = "";
+    char dirty_path[EUCA_MAX_PATH] = "";
+    struct stat mystat = { 0 };
+
+    snprintf(path, sizeof(path), "%s/%s", cache_path, CACHE_INDEX_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s.%d", cache_path, CACHE_INDEX_FILE, getpid());
+    snprintf(dirty_path, sizeof(dirty_path), "%s/%s", cache_path, CACHE_INDEX_DIRTY);
+
+    if ((fp = fopen(tmp_path, "w")) == NULL) {
+        LOGWARN("failed to write the cache index '%s': %s\n", tmp_path, strerror(errno));
+        return EUCA_ERROR;
+    }
+
+    // oldest entries first, so that loading the index rebuilds the list in the same order
+    for (e = cache_head; e && e->next; e = e->next) ;
+
+    fprintf(fp, CACHE_INDEX_HEADER);
+    for (; e; e = e->prev) {
+        fprintf(fp, "%lld\t%lld\t%s\n", ((long long)e->content_size), ((long long)e->total_size), e->id);
+    }
+
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0) || ferror(fp)) {
+        LOGWARN("failed to write the cache index '%s': %s\n", tmp_path, strerror(errno));
+        fclose(fp);
+        unlink(tmp_path);
+        return EUCA_ERROR;
+    }
+    fclose(fp);
+
+    if (rename(tmp_path, path) != 0) {
+        LOGWARN("failed to replace the cache index '%s': %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return EUCA_ERROR;
+    }
+
+    if (stat(path, &mystat) == 0)
+        cache_index_ino = mystat.st_ino;
+    unlink(dirty_path);
+    return EUCA_OK;
+}
+
+//!
+//! Reads the entries of the cache from its index, unless the index is missing, of another
+//! format or marked as outdated by mark_cache_index(), merging them with those in memory
+//!
+//! @return EUCA_OK if the entries were read or EUCA_ERROR if scan_cache() must rebuild them
+//!
+static int load_cache_index(void)
+{
+    int ret = EUCA_ERROR;
+    char *index = NULL;
+    char *line = NULL;
+    char *next = NULL;
+    char *id = NULL;
+    long long content_size = 0;
+    long long total_size = 0;
+    char path[EUCA_MAX_PATH] = "";
+    hashtable *seen = NULL;
+    struct stat mystat = { 0 };
+
+    snprintf(path, sizeof(path), "%s/%s", cache_path, CACHE_INDEX_DIRTY);
+    if (stat(path, &mystat) == 0) {
+        LOGINFO("cache index of '%s' is outdated\n", cache_path);
+        return EUCA_ERROR;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", cache_path, CACHE_INDEX_FILE);
+    if ((stat(path, &mystat) < 0) || ((index = file2str(path)) == NULL)) {
+        LOGINFO("no cache index in '%s'\n", cache_path);
+        return EUCA_ERROR;
+    }
+
+    if ((seen = hashtable_create(CACHE_INDEX_SLOTS)) == NULL)
+        goto out;
+
+    if (strncmp(index, CACHE_INDEX_HEADER, strlen(CACHE_INDEX_HEADER))) {
+        LOGWARN("unknown format of cache index '%s'\n", path);
+        goto out;
+    }
+
+    for (line = index + strlen(CACHE_INDEX_HEADER); (line != NULL) && (*line != '\0'); line = next) {
+        if ((next = strchr(line, '\n')) == NULL) {
+            LOGWARN("truncated cache index '%s'\n", path);
+            goto out;
         }
-        // if first entry
-        if (pp) {
-            *pp = di;
+        *next++ = '\0';
+
+        content_size = strtoll(line, &id, 10);
+        if (*id == '\t')
+            total_size = strtoll(id + 1, &id, 10);
+        if ((*id != '\t') || (*(++id) == '\0')) {
+            LOGWARN("invalid entry '%s' in cache index '%s'\n", line, path);
+            goto out;
         }
-        cache_used += di->total_size;
+
+        if (merge_into_cache(id, content_size, total_size, seen) == NULL)
+            goto out;
     }
+
+    prune_cache(seen);
+    cache_index_ino = mystat.st_ino;
+    ret = EUCA_OK;
+
+out:
+    hashtable_free(seen);
+    EUCA_FREE(index);
+    return ret;
+}
+
+//!
+//! Brings the cache state in memory up to date with the disk, when it is first needed or
+//! another process changed the index, from the index if it can be trusted and with
+//! scan_cache() otherwise
+//!
+static void ensure_cache_loaded(void)
+{
+    char path[EUCA_MAX_PATH] = "";
+    struct stat mystat = { 0 };
+
+    if (cache_loaded) {
+        snprintf(path, sizeof(path), "%s/%s", cache_path, CACHE_INDEX_FILE);
+        if ((stat(path, &mystat) == 0) && (mystat.st_ino == cache_index_ino))
+            return;
+        LOGINFO("cache index of '%s' was changed by another process\n", cache_path);
+    }
+
+    if (load_cache_index() == EUCA_OK) {
+        LOGINFO("loaded the index of the cache directory (%s)\n", cache_path);
+        print_cache();
+    } else {
+        scan_cache();
+    }
+    cache_loaded = TRUE;
 }
 
 //!
@@ -377,9 +657,10 @@ int reserve_cache_slot(disk_item * di)
     if (di == NULL)
         return EUCA_INVALID_ERROR;
 
+    ensure_cache_loaded();
+
     //! @TODO check if there is enough disk space?
     if (cache_limit == EUCA_SIZE_UNLIMITED) {   // cache is always big enough, we never purge
-        cache_used += di->total_size;
         goto create;
     }
 
@@ -414,18 +695,7 @@ int reserve_cache_slot(disk_item * di)
 
         if (oldest_entry) {            // remove it
             LOGINFO("purging from cache entry %s\n", oldest_entry->base);
-            if (oldest_entry->next) {
-                oldest_entry->next->prev = oldest_entry->prev;
-            }
-
-            if (oldest_entry->prev) {
-                oldest_entry->prev->next = oldest_entry->next;
-            } else {
-                cache_head = oldest_entry->next;
-            }
-
-            delete_disk_item(oldest_entry);
-            cache_used -= oldest_entry->total_size;
+            delete_disk_item(oldest_entry); // also takes it out of the cache and its index
             FREE_DISK_ITEM(oldest_entry);
         } else {
             LOGERROR("cannot find oldest entry in cache\n");
@@ -434,17 +704,20 @@ int reserve_cache_slot(disk_item * di)
     }
 
 create:
+    mark_cache_index();
     if (ensure_path_exists(di->base, 0700)) {
         LOGERROR("failed to create cache entry '%s'\n", di->base);
         return EUCA_ERROR;
     }
 
     add_to_cache(di);
+    save_cache_index();
     return EUCA_OK;
 }
 
 //!
-//!
+//! Gives back cache space accounted for but not used, which only changes the counter in
+//! memory: the index on disk holds the entries, whose sizes are not affected
 //!
 //! @param[in] size
 //!
@@ -454,10 +727,13 @@ void return_cache_path(s64 size)
 }
 
 //!
-//!
+//! Rebuilds the cache state in memory and its index from the content of the cache
+//! directory, which is only needed when the index is missing or outdated
 //!
 //! @return The size of the cache or -1L if any error occured
 //!
+//! @see ensure_cache_loaded()
+//!
 s64 scan_cache(void)
 {
     s64 total_size = 0;
@@ -472,23 +748,11 @@ s64 scan_cache(void)
     char image_path[EUCA_MAX_PATH] = "";
     boolean found_content = FALSE;
     boolean found_summary = FALSE;
-    disk_item *d = NULL;
-    disk_item *di = NULL;
-    disk_item *prev_d = NULL;
+    hashtable *seen = NULL;
     struct stat mystat = { 0 };
     struct dirent *cache_dir_entry = NULL;
     struct dirent *image_dir_entry = NULL;
 
-    // remove old LL
-    while ((d = cache_head) != NULL) {
-        prev_d = d;
-        d = d->next;
-        prev_d->next = NULL;
-        prev_d->prev = NULL;
-        FREE_DISK_ITEM(prev_d);
-    }
-    cache_head = NULL;
-
     LOGINFO("scanning the cache directory (%s)\n", cache_path);
 
     if (strlen(cache_path) == 0) {
@@ -506,6 +770,12 @@ s64 scan_cache(void)
         LOGFATAL("could not open cache directory %s\n", cache_path);
         return -1L;
     }
+
+    if ((seen = hashtable_create(CACHE_INDEX_SLOTS)) == NULL) {
+        LOGFATAL("out of memory for the cache index\n");
+        closedir(cache_dir);
+        return -1L;
+    }
     // iterate over all directories in cache directory
     while ((cache_dir_entry = readdir(cache_dir)) != NULL) {
         image_name = cache_dir_entry->d_name;
@@ -516,6 +786,9 @@ s64 scan_cache(void)
         if (!strcmp(".", image_name) || !strcmp("..", image_name))
             continue;
 
+        if (!strncmp(CACHE_INDEX_FILE, image_name, strlen(CACHE_INDEX_FILE)))
+            continue;
+
         snprintf(image_path, EUCA_MAX_PATH, "%s/%s", cache_path, image_name);
         if ((image_dir = opendir(image_path)) == NULL) {
             LOGWARN("unopeneable directory %s\n", image_path);
@@ -569,16 +842,20 @@ s64 scan_cache(void)
                 LOGINFO("- cached image '%s': size=%ldMB, files=%d\n", image_name, (image_size / MEGABYTE), image_files);
                 total_size += image_size;
 
-                // allocate a disk item object
-                di = alloc_disk_item(image_name, content_size, image_size, TRUE);
-                add_to_cache(di);
+                // allocate a disk item object, or refresh the one in memory
+                merge_into_cache(image_name, content_size, image_size, seen);
             } else {
                 LOGWARN("empty cached image directory %s\n", image_path);
             }
         }
     }
     closedir(cache_dir);
+    prune_cache(seen);
+    hashtable_free(seen);
     print_cache();
+
+    save_cache_index();
+    cache_loaded = TRUE;
     return total_size;
 }
 
@@ -981,7 +1258,8 @@ int add_summ_disk_item(disk_item * di, artifacts_spec * spec)
 }
 
 //!
-//! Deletes on disk state for the item, but does nothing in memory
+//! Deletes on disk state for the item and, for a cache item, takes it out of the cache
+//! and its index, so that the caller may free it
 //!
 //! @param[in] di
 //!
@@ -991,6 +1269,9 @@ int delete_disk_item(disk_item * di)
 {
     int ret = EUCA_OK;
 
+    if (di->cache_item)
+        mark_cache_index();
+
     if (unlink(di->path)) {
         LOGERROR("failed to delete '%s'\n", di->path);
         ret = EUCA_ERROR;
@@ -1005,6 +1286,9 @@ int delete_disk_item(disk_item * di)
             LOGERROR("failed to delete '%s'\n", di->base);
             ret = EUCA_ERROR;
         }
+
+        remove_from_cache(di);
+        save_cache_index();
     }
 
     return ret;
@@ -1023,6 +1307,7 @@ int delete_disk_item(disk_item * di)
 disk_item *find_disk_item(const char *id, const boolean cache_item)
 {
     char path[EUCA_MAX_PATH] = "";
+    disk_item *di = NULL;
     struct stat mystat = { 0 };
 
     if (cache_item) {
@@ -1032,8 +1317,21 @@ disk_item *find_disk_item(const char *id, const boolean cache_item)
     }
 
     if (cache_item) {
-        scan_cache();                  // rebuilds cache state in memory based on disk
-        return find_in_cache(path);
+        ensure_cache_loaded();         // reads the index, or rebuilds it from the disk
+        if ((di = find_in_cache(path)) == NULL)
+            return NULL;
+
+        if (stat(di->base, &mystat) < 0) {
+            LOGWARN("cache entry '%s' is gone from the disk\n", di->base);
+            mark_cache_index();
+            remove_from_cache(di);     // not freed, see prune_cache()
+            save_cache_index();
+            return NULL;
+        }
+
+        if (stat(di->path, &mystat) == 0)
+            di->content_size = mystat.st_size;
+        return di;
     }
 
     if (stat(path, &mystat) < 0) {
@@ -76,6 +76,7 @@ extern imager_command known_cmds[EUCA_NB_IMAGER_CMD];
 const char **fsck_parameters(void);
 artifact *fsck_requirements(imager_request * req, artifact * prev_art) _attribute_wur_;
 int fsck_validate(imager_request * req);
+int fsck_blobstores(blobstore * work_bs, int (*work_examiner) (const blockblob * bb), blobstore * cache_bs);
 //! @}
 
 //! @{
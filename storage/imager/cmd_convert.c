@@ -34,6 +34,10 @@
 #include <unistd.h>                    // access
 #include <assert.h>                    // duh
 #include <errno.h>
+#include <fcntl.h>                     // open
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>                  // waitpid
 
 #include "eucalyptus.h"
 #include "misc.h"
@@ -62,8 +66,14 @@
 #define _VDC                                     "vsphere-datacenter"
 #define _VMX                                     "vsphere-vmx"
 #define _VMDK                                    "vsphere-vmdk"
+#define _WORKERS                                 "workers"
+#define _STRIPE                                  "stripe"
 
 #define DEFAULT_BUFFER_SIZE_BYTES                262144L
+#define DEFAULT_WORKERS                          1
+#define DEFAULT_STRIPE_SECTORS                   2097152LL  //!< 1GB worth of sectors handed to a worker at a time
+#define MAX_WORKERS                              32
+#define VDDK_SECTOR_BYTES                        512    //!< VIXDISKLIB_SECTOR_SIZE, the unit of in-range and stripe
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -94,6 +104,8 @@ typedef struct _convert_params {
     long long start_sector;
     long long end_sector;
     long long buf_size_bytes;
+    int workers;
+    long long stripe_sectors;
     char *login;
     char *out;
     char *password;
@@ -137,6 +149,8 @@ static const char *params[] = {
     _VMDK, "vSphere path to the disk, including the datastore",
     _VMX, "vSphere path to the VMX, including the datastore",
     _BUFSIZE, "internal buffer size, in bytes (default: 256K)",
+    _WORKERS, "number of parallel remote conversion streams (default: 1)",
+    _STRIPE, "sectors converted by a stream at a time (default: 2097152, i.e., 1GB)",
     NULL,
 };
 
@@ -147,6 +161,7 @@ static const char *params[] = {
 \*----------------------------------------------------------------------------*/
 
 static enum content_type parse_content_type_enum(const char *s);
+static int convert_parallel(convert_params * state, const char *in_path, const char *out_path, s64 size_bytes);
 static int convert_creator(artifact * a);
 
 /*----------------------------------------------------------------------------*\
@@ -266,6 +281,18 @@ int convert_validate(imager_request * req)
             state->buf_size_bytes = strtoll(p->val, &endptr, 10);
             if (errno != 0 && *endptr != '\0')
                 err("failed to parse buffer size parameter " _BUFSIZE);
+        } else if (strcmp(p->key, _WORKERS) == 0) {
+            char * endptr;
+            errno = 0;
+            state->workers = strtol(p->val, &endptr, 10);
+            if ((errno != 0) || (*endptr != '\0') || (state->workers < 1) || (state->workers > MAX_WORKERS))
+                err("failed to parse number of workers parameter " _WORKERS " (1-%d)", MAX_WORKERS);
+        } else if (strcmp(p->key, _STRIPE) == 0) {
+            char * endptr;
+            errno = 0;
+            state->stripe_sectors = strtoll(p->val, &endptr, 10);
+            if ((errno != 0) || (*endptr != '\0') || (state->stripe_sectors < 1))
+                err("failed to parse stripe size parameter " _STRIPE);
         } else {
             err("invalid parameter '%s' for command 'convert'", p->key);
         }
@@ -363,6 +390,14 @@ int convert_validate(imager_request * req)
     if (state->buf_size_bytes == 0) {
         state->buf_size_bytes = DEFAULT_BUFFER_SIZE_BYTES;
     }
+    if (state->workers == 0) {
+        state->workers = DEFAULT_WORKERS;
+    }
+    if (state->stripe_sectors == 0) {
+        state->stripe_sectors = DEFAULT_STRIPE_SECTORS;
+    }
+    if ((state->workers > 1) && (state->remote == NULL))
+        err("parameter '" _WORKERS "' only applies to remote conversions");
 
     req->internal = ((void *)state);   // save pointer to find it later
     return (EUCA_OK);
@@ -458,6 +493,110 @@ artifact *convert_requirements(imager_request * req, artifact * prev_art)
     return this_art;
 }
 
+//!
+//! Converts the [start, end] sector window of a remote conversion in stripes of
+//! stripe_sectors, each one handled by a child process of its own that makes a separate
+//! VDDK connection through the shim. Stripes are handed out as workers finish, so that
+//! the fast, mostly empty, regions of the disk do not hold back the others. Each stripe
+//! is read from and written to its own offset, so a local output file is created with
+//! the full size of the disk before the workers start.
+//!
+//! @param[in] state parameters of the conversion
+//! @param[in] in_path local input, for conversions to a remote VMDK
+//! @param[in] out_path local output, for conversions from a remote VMDK
+//! @param[in] size_bytes size of the disk
+//!
+//! @return EUCA_OK if all stripes were converted or EUCA_ERROR otherwise
+//!
+static int convert_parallel(convert_params * state, const char *in_path, const char *out_path, s64 size_bytes)
+{
+    int fd = -1;
+    int rc = EUCA_ERROR;
+    int ret = EUCA_OK;
+    int status = 0;
+    int running = 0;
+    int stripes = 0;
+    int stripes_done = 0;
+    pid_t pid = -1;
+    time_t before = time(NULL);
+    long long next = 0;
+    long long stripe_end = 0;
+    long long first = state->start_sector;
+    long long last = state->end_sector;
+    long long disk_sectors = (size_bytes / VDDK_SECTOR_BYTES) + (((size_bytes % VDDK_SECTOR_BYTES) > 0) ? 1 : 0);
+
+    if (last == 0) {                   // 0 is special value meaning the whole disk
+        last = disk_sectors - 1;
+    }
+    if ((first < 0) || (last > (disk_sectors - 1)) || (first > last)) {
+        LOGERROR("sector range %lld-%lld is out of range of the disk (%lld sectors)\n", first, last, disk_sectors);
+        return EUCA_ERROR;
+    }
+
+    if (state->in_type == VMDK) {
+        if ((fd = open(out_path, O_CREAT | O_EXCL | O_WRONLY, 0600)) < 0) {
+            LOGERROR("failed to create the output file '%s': %s\n", out_path, strerror(errno));
+            return EUCA_ERROR;
+        }
+        if (ftruncate(fd, (disk_sectors * VDDK_SECTOR_BYTES)) != 0) {
+            LOGERROR("failed to size the output file '%s': %s\n", out_path, strerror(errno));
+            close(fd);
+            return EUCA_ERROR;
+        }
+        close(fd);
+    }
+
+    stripes = ((last - first) / state->stripe_sectors) + 1;
+    LOGINFO("converting sectors %lld-%lld in %d stripes of %lld sectors with %d workers\n", first, last, stripes, state->stripe_sectors, state->workers);
+
+    // after a failure no new stripes are handed out, but the running ones are waited for
+    for (next = first; (running > 0) || ((ret == EUCA_OK) && (next <= last));) {
+        if ((ret == EUCA_OK) && (next <= last) && (running < state->workers)) {
+            stripe_end = MIN((next + state->stripe_sectors - 1), last);
+            if ((pid = fork()) < 0) {
+                LOGERROR("failed to fork a conversion worker: %s\n", strerror(errno));
+                ret = EUCA_ERROR;
+                continue;
+            }
+
+            if (pid == 0) {
+                if (state->in_type == DISK) {
+                    rc = vmdk_convert_to_remote(in_path, state->remote, next, stripe_end, state->buf_size_bytes);
+                } else {
+                    rc = vmdk_convert_from_remote(state->remote, out_path, next, stripe_end, state->buf_size_bytes);
+                }
+                _exit((rc == EUCA_OK) ? 0 : 1);
+            }
+
+            LOGDEBUG("conversion worker %d started on sectors %lld-%lld\n", pid, next, stripe_end);
+            running++;
+            next = stripe_end + 1;
+            continue;
+        }
+
+        if ((pid = waitpid(-1, &status, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to wait for the conversion workers: %s\n", strerror(errno));
+            return EUCA_ERROR;
+        }
+
+        running--;
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            LOGERROR("conversion worker %d failed\n", pid);
+            ret = EUCA_ERROR;
+        } else {
+            stripes_done++;
+            LOGDEBUG("conversion progress %d/%d stripes after %d seconds\n", stripes_done, stripes, (int)(time(NULL) - before));
+        }
+    }
+
+    if (ret == EUCA_OK) {
+        LOGINFO("parallel conversion of %lldMB took %d seconds\n", (((last - first + 1) * VDDK_SECTOR_BYTES) / 1000000), (int)(time(NULL) - before));
+    }
+    return ret;
+}
+
 //!
 //! Creator callback for the convert operation
 //!
@@ -497,7 +636,17 @@ static int convert_creator(artifact * a)
 
     // do the conversion to create the artifact
     LOGINFO("converting from '%s' to '%s'\n", in_path, out_path);
-    if (state->remote) {
+    if (state->remote && (state->workers > 1)) {
+        // streams need the size of the disk to be split up and cannot share a pipe
+        if ((a->size_bytes <= 0) || !strcmp(in_path, "-") || !strcmp(out_path, "-")) {
+            LOGWARN("cannot convert a stream or a disk of unknown size in parallel, using a single stream\n");
+            state->workers = 1;
+        }
+    }
+
+    if (state->remote && (state->workers > 1)) {
+        ret = convert_parallel(state, in_path, out_path, a->size_bytes);
+    } else if (state->remote) {
         switch(state->in_type) {
         case DISK:
             ret = vmdk_convert_to_remote(in_path, state->remote, state->start_sector, state->end_sector, state->buf_size_bytes);
@@ -30,11 +30,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include <eucalyptus.h>
 #include <diskutil.h>
 #include <assert.h>
 #include "imager.h"
 #include "vmdk.h"
+#include "cmd.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -42,6 +45,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define _CHECK                                   "check"
+#define MAX_FSCK_STORES                          2  //!< the work and the cache blobstores
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -60,6 +66,16 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A blobstore being checked, by a thread of its own
+typedef struct _fsck_store {
+    const char *name;                  //!< for the logs
+    blobstore *bs;
+    int (*examiner) (const blockblob * bb);
+    int check_devices;                 //!< TRUE for the deep pass
+    blobstore_fsck_stats stats;        //!< of the pass
+    int ret;                           //!< result of the pass
+} fsck_store;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -81,9 +97,13 @@
 \*----------------------------------------------------------------------------*/
 
 static const char *params[] = {
+    _CHECK, "pass(es) to run over the work and cache stores: {fast|deep|both} (default=both, i.e. fast on both, then deep)",
     NULL,
 };
 
+static boolean fast_pass = TRUE;       //!< check the metadata of all blobs first
+static boolean deep_pass = TRUE;       //!< then check their devices as well
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED PROTOTYPES                            |
@@ -99,6 +119,9 @@ int fsck_validate(imager_request * req);
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void *fsck_store_thread(void *arg);
+static int fsck_run_pass(fsck_store * stores, int nstores, int check_devices);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -130,8 +153,29 @@ const char **fsck_parameters(void)
 //!
 int fsck_validate(imager_request * req)
 {
+    imager_param *p = NULL;
+
     print_req(req);
 
+    for (p = req->params; p != NULL && p->key != NULL; p++) {
+        if (strcmp(p->key, _CHECK) == 0) {
+            if (strcmp(p->val, "fast") == 0) {
+                fast_pass = TRUE;
+                deep_pass = FALSE;
+            } else if (strcmp(p->val, "deep") == 0) {
+                fast_pass = FALSE;
+                deep_pass = TRUE;
+            } else if (strcmp(p->val, "both") == 0) {
+                fast_pass = TRUE;
+                deep_pass = TRUE;
+            } else {
+                err("invalid value '%s' for parameter '%s' of command 'fsck'", p->val, _CHECK);
+            }
+        } else {
+            err("invalid parameter '%s' for command 'fsck'", p->key);
+        }
+    }
+
     if (diskutil_init(TRUE)) {         // imager may need GRUB
         LOGERROR("failed to initialize diskutil\n");
         return EUCA_ERROR;
@@ -170,3 +214,110 @@ artifact *fsck_requirements(imager_request * req, artifact * prev_art)
     art_add_dep(this_art, prev_art);
     return this_art;
 }
+
+//!
+//! Checks the work and the cache blobstores at the same time, each with its
+//! own thread (the devices of the blobs within a store are checked by a pool of
+//! threads of the blobstore). Unless 'check=' said otherwise, a fast pass over
+//! the metadata of all blobs of both stores is done first, so that the bulk of
+//! the problems is dealt with early, and the deep pass over their devices after.
+//!
+//! @param[in] work_bs the work blobstore, or NULL
+//! @param[in] work_examiner condemns blobs of the work blobstore
+//! @param[in] cache_bs the cache blobstore, or NULL
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if any check failed
+//!
+int fsck_blobstores(blobstore * work_bs, int (*work_examiner) (const blockblob * bb), blobstore * cache_bs)
+{
+    int ret = EUCA_OK;
+    int nstores = 0;
+    long long started = mono_time_usec();
+    fsck_store stores[MAX_FSCK_STORES] = { {0} };
+
+    if (cache_bs) {
+        stores[nstores].name = "cache";
+        stores[nstores].bs = cache_bs;
+        nstores++;
+    }
+    if (work_bs) {
+        stores[nstores].name = "work";
+        stores[nstores].bs = work_bs;
+        stores[nstores].examiner = work_examiner;
+        nstores++;
+    }
+
+    if (fast_pass && (fsck_run_pass(stores, nstores, FALSE) != EUCA_OK))
+        ret = EUCA_ERROR;
+    if (deep_pass && (fsck_run_pass(stores, nstores, TRUE) != EUCA_OK))
+        ret = EUCA_ERROR;
+
+    LOGINFO("fsck of %d blobstore(s) %s in %.3fs\n", nstores, ((ret == EUCA_OK) ? "done" : "failed"), ((mono_time_usec() - started) / 1000000.0));
+    return ret;
+}
+
+//!
+//! Thread checking one blobstore
+//!
+//! @param[in] arg the fsck_store to check
+//!
+//! @return NULL
+//!
+static void *fsck_store_thread(void *arg)
+{
+    fsck_store *store = (fsck_store *) arg;
+
+    store->ret = blobstore_fsck_pass(store->bs, store->examiner, store->check_devices, &(store->stats));
+    return NULL;
+}
+
+//!
+//! Runs one pass over all the stores at once and logs how it went for each
+//!
+//! @param[in] stores
+//! @param[in] nstores
+//! @param[in] check_devices TRUE for the deep pass, FALSE for the fast one
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the check of any store failed
+//!
+static int fsck_run_pass(fsck_store * stores, int nstores, int check_devices)
+{
+    int i = 0;
+    int ret = EUCA_OK;
+    boolean started[MAX_FSCK_STORES] = { FALSE };
+    pthread_t threads[MAX_FSCK_STORES];
+    const char *pass = (check_devices ? "deep" : "fast");
+
+    LOGINFO("fsck: %s pass over %d blobstore(s)\n", pass, nstores);
+    for (i = 0; i < nstores; i++) {
+        stores[i].check_devices = check_devices;
+        if ((i > 0) && (pthread_create(&threads[i], NULL, fsck_store_thread, &stores[i]) == 0)) {
+            started[i] = TRUE;
+        } else if (i > 0) {
+            LOGWARN("failed to start an fsck thread, checking the %s blobstore after the others\n", stores[i].name);
+        }
+    }
+
+    // the calling thread checks the first store, and those for which no thread could be started
+    for (i = 0; i < nstores; i++) {
+        if (!started[i])
+            fsck_store_thread(&stores[i]);
+    }
+
+    for (i = 0; i < nstores; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+        if (stores[i].ret) {
+            LOGERROR("fsck: %s pass over the %s blobstore failed: %s\n", pass, stores[i].name, blobstore_get_error_str(blobstore_get_error()));
+            ret = EUCA_ERROR;
+            continue;
+        }
+
+        LOGINFO("fsck: %s pass over the %s blobstore took %.3fs: %u blob(s), %u unchanged, %u deleted, %u undeletable, %u in use\n",
+                pass, stores[i].name, (stores[i].stats.usec / 1000000.0), stores[i].stats.num_blobs, stores[i].stats.num_skipped, stores[i].stats.num_deleted,
+                stores[i].stats.num_failed, stores[i].stats.num_unopenable);
+    }
+
+    return ret;
+}
@@ -33,9 +33,11 @@
 #include <assert.h>
 #include <string.h>                    // strcmp
 #include <unistd.h>                    // access
+#include <errno.h>
 #include <eucalyptus.h>
 #include <misc.h>
 #include <objectstorage.h>
+#include <http.h>
 #include <euca_string.h>
 #include <map.h>
 #include "imager.h"
@@ -59,6 +61,14 @@
 #define _VDC                                     "vsphere-datacenter"
 #define _VMX                                     "vsphere-vmx"
 #define _VMDK                                    "vsphere-vmdk"
+#define _PART_SIZE                               "part-size"
+#define _STREAMS                                 "streams"
+#define _CHECKSUM                                "checksum"
+#define _CHUNKS                                  "chunks"
+
+#define DEFAULT_PART_BYTES                       (64LL * 1024 * 1024)
+#define DEFAULT_STREAMS                          4
+#define MAX_STREAMS                              16
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -92,6 +102,10 @@ typedef struct _upload_params {
     char *vmdk;
     char *vmx;
     img_spec *remote;
+    long long part_bytes;              //!< size of the parts of a multipart upload to a URL
+    int streams;                       //!< parts uploaded at once
+    boolean checksum;                  //!< whether each part is sent with its MD5
+    boolean chunks;                    //!< whether the object goes up as a chunk manifest, sending only the changed chunks
     enum dest_type {
         _WEB = 0,
         _VSPHERE,
@@ -127,6 +141,10 @@ static const char *params[] = {
     _VDC, "vSphere datacenter name",
     _VMDK, "vSphere path to the disk, including the datastore",
     _VMX, "vSphere path to the VMX, including the datastore",
+    _PART_SIZE, "for URLs, size of the parts of a multipart upload (default: 64M)",
+    _STREAMS, "for URLs, parts uploaded at once (default: 4)",
+    _CHECKSUM, "for URLs, send the MD5 of each part: {yes|no} (default: yes)",
+    _CHUNKS, "for URLs, upload a manifest of content-defined chunks and only the chunks the server lacks: {yes|no} (default: no)",
     NULL,
 };
 
@@ -202,18 +220,30 @@ int upload_validate(imager_request * req)
 
     print_req(req);
 
-    if (vddk_available == FALSE) {
-        LOGERROR("failed to initialize VMware's VDDK (is LD_LIBRARY_PATH set?)\n");
-        return EUCA_ERROR;
-    }
-
     if ((state = EUCA_ZALLOC(1, sizeof(upload_params))) == NULL)
         err("out of memory");
 
+    state->part_bytes = DEFAULT_PART_BYTES;
+    state->streams = DEFAULT_STREAMS;
+    state->checksum = TRUE;
+
     // record in 'state' all specified parameters
     for (p = req->params; p != NULL && p->key != NULL; p++) {
         if (strcmp(p->key, _IN) == 0) {
             state->in = p->val;
+        } else if (strcmp(p->key, _PART_SIZE) == 0) {
+            if ((state->part_bytes = parse_bytes(p->val)) < 1)
+                err("failed to parse part size parameter " _PART_SIZE);
+        } else if (strcmp(p->key, _STREAMS) == 0) {
+            char *endptr;
+            errno = 0;
+            state->streams = strtol(p->val, &endptr, 10);
+            if ((errno != 0) || (*endptr != '\0') || (state->streams < 1) || (state->streams > MAX_STREAMS))
+                err("failed to parse number of streams parameter " _STREAMS " (1-%d)", MAX_STREAMS);
+        } else if (strcmp(p->key, _CHECKSUM) == 0) {
+            state->checksum = parse_boolean(p->val);
+        } else if (strcmp(p->key, _CHUNKS) == 0) {
+            state->chunks = parse_boolean(p->val);
         } else if (strcmp(p->key, _ITYPE) == 0) {
             state->in_type = parse_content_type_enum(p->val);
         } else if (strcmp(p->key, _LOGIN) == 0) {
@@ -283,6 +313,13 @@ int upload_validate(imager_request * req)
         err("output format not recognized/supported");
     }
 
+    if ((state->out_type == _VSPHERE) && (vddk_available == FALSE)) {   // plain URLs are uploaded to with libcurl
+        LOGERROR("failed to initialize VMware's VDDK (is LD_LIBRARY_PATH set?)\n");
+        EUCA_FREE(spec);
+        EUCA_FREE(state);
+        return EUCA_ERROR;
+    }
+
     if (state->vdc) {
         euca_strncpy(loc->vsphere_dc, state->vdc, sizeof(loc->vsphere_dc));
     }
@@ -385,7 +422,10 @@ static int upload_creator(artifact * a)
     LOGINFO("uploading to '%s'\n", state->out);
     switch (state->out_type) {
     case _WEB:
-        err("upload to arbitrary URLs not supported, sorry");
+        if (state->chunks)
+            ret = http_put_chunks(in_path, state->out, state->login, state->password);
+        else
+            ret = http_put_parts(in_path, state->out, state->login, state->password, state->part_bytes, state->streams, state->checksum);
         break;
     case _VSPHERE:{
             if (state->in_type == _VMDK_CONT) {
@@ -28,6 +28,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE                    // SEEK_DATA
 #include <stdlib.h>                    // NULL
 #include <stdio.h>
 #include <string.h>                    // bzero, memcpy
@@ -36,6 +37,7 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>                     // open
 #include <errno.h>
 
 #include <eucalyptus.h>
@@ -45,6 +47,7 @@
 
 #include "diskfile.h"
 #include "imager.h"
+#include "cache.h"                     // alloc_tmp_file
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -52,6 +55,34 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define MBR_DISK_ID_OFFSET                       440    //!< in sector 0
+#define MBR_TABLE_OFFSET                         446    //!< first of the partition entries in sector 0
+#define MBR_ENTRY_BYTES                          16
+#define MBR_MAX_ENTRIES                          4  //!< primary partitions only, as 'parted mkpart primary' did
+#define MBR_SIGNATURE_OFFSET                     510
+#define MBR_FIRST_SECTOR                         63 //!< the starting sector for 'msdos' MBRs
+#define MBR_ID_NTFS                              0x07
+#define MBR_ID_SWAP                              0x82
+#define MBR_ID_LINUX                             0x83
+#define MBR_ID_GPT                               0xEE   //!< protective entry covering a GPT disk
+#define CHS_HEADS                                255
+#define CHS_SECTORS                              63
+
+#define GPT_SIGNATURE                            "EFI PART"
+#define GPT_REVISION                             0x00010000
+#define GPT_HEADER_BYTES                         92
+#define GPT_ENTRIES                              128
+#define GPT_ENTRY_BYTES                          128
+#define GPT_TABLE_SECTORS                        ((GPT_ENTRIES * GPT_ENTRY_BYTES) / SECTOR_SIZE)
+#define GPT_FIRST_SECTOR                         2048   //!< where partitions start, aligned to 1MB
+
+#define SWAP_PAGE_BYTES                          4096   //!< page size of the guests using the swap
+#define SWAP_MIN_PAGES                           10
+#define SWAP_HEADER_OFFSET                       1024
+#define SWAP_SIGNATURE                           "SWAPSPACE2"
+
+#define COPY_BUFFER_BYTES                        (1024 * 1024)
+
 #define SECTOR_SIZE                               512   //!< small enough and yet not too small
 #define MIN_DF_BYTES                             (512 * 8)  //!< big enough for swap, any better ideas?
 
@@ -102,12 +133,46 @@ static const char *_pformats[sizeof(enum pformat_t)] = {
     "ntfs",
 };
 
+//! MBR partition ids, indexed by enum diskpart_t
+static const u8 _mbr_ids[sizeof(enum diskpart_t)] = {
+    MBR_ID_LINUX,
+    MBR_ID_SWAP,
+    MBR_ID_LINUX,
+    MBR_ID_NTFS,
+};
+
+//! GPT partition type GUIDs, in on-disk byte order, indexed by enum diskpart_t
+static const unsigned char _gpt_types[sizeof(enum diskpart_t)][16] = {
+    {0},
+    {0x6D, 0xFD, 0x57, 0x06, 0xAB, 0xA4, 0xC4, 0x43, 0x84, 0xE5, 0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F},   // Linux swap
+    {0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84, 0x72, 0x47, 0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4},   // Linux file system
+    {0xA2, 0xA0, 0xD0, 0xEB, 0xE5, 0xB9, 0x33, 0x44, 0x87, 0xC0, 0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7},   // Microsoft basic data
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void put_le16(unsigned char *buf, u16 val);
+static void put_le32(unsigned char *buf, u32 val);
+static void put_le64(unsigned char *buf, u64 val);
+static u32 get_le32(const unsigned char *buf);
+static u64 get_le64(const unsigned char *buf);
+static u32 crc32_gpt(const unsigned char *buf, size_t len);
+static void random_bytes(unsigned char *buf, size_t len);
+static void lba_to_chs(s64 lba, unsigned char *chs);
+static void put_mbr_entry(unsigned char *entry, u8 id, s64 first_sector, s64 last_sector);
+static void put_gpt_header(unsigned char *hdr, s64 my_lba, s64 alt_lba, s64 table_lba, s64 last_lba, const unsigned char *guid, u32 table_crc);
+static int write_sectors(const char *path, s64 sector, const unsigned char *buf, s64 sectors);
+static int write_mbr(diskfile * df);
+static int write_gpt(diskfile * df);
+static int read_gpt(diskfile * df, int fd);
+static int read_partitions(diskfile * df);
+static int write_swap(const char *path, s64 offset, s64 size_bytes);
+static int write_ext3(diskfile * df, diskpart * p, s64 size_bytes);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -198,9 +263,6 @@ diskfile *df_create(const char *path, const s64 limit_bytes, boolean zero_fill)
 //!
 diskfile *df_open(const char *path)
 {
-    int p = 0;
-    s64 last = 0;
-    s64 first = 0;
     diskfile *df = NULL;
 
     if (!diskutil_initialized) {
@@ -227,25 +289,15 @@ diskfile *df_open(const char *path)
     df->size_sectors = df->limit_bytes / SECTOR_SIZE;
 
     // discover the partitions, if any
-    for (p = 0; p < MAX_PARTS; p++) {
-        first = 0;
-        last = 0;
-        if (diskutil_sectors(df->path, p, ((long long *)&first), ((long long *)&last)) == EUCA_OK) {
-            LOGINFO("partition %d: [%ld-%ld]\n", p, first, last);
-            df->parts[p].first_sector = first;
-            df->parts[p].last_sector = last;
-            df->parts[p].size_bytes = (last - first + 1) * SECTOR_SIZE;
-            df->nparts++;
-        } else {
-            if (df->nparts > 0) {      // some partitions found, so this is a disk
-                df->mbr = MBR_MSDOS;   //! @TODO verify that it's 'msdos'
-            } else {                   // no partitions found, so record sector information in part[0]
-                df->parts[0].first_sector = 0;
-                df->parts[0].last_sector = df->size_sectors - 1;
-                df->parts[0].size_bytes = df->size_sectors * SECTOR_SIZE;
-            }
-            break;
-        }
+    if (read_partitions(df) != EUCA_OK) {
+        EUCA_FREE(df);
+        return NULL;
+    }
+
+    if (df->nparts == 0) {             // no partitions found, so record sector information in part[0]
+        df->parts[0].first_sector = 0;
+        df->parts[0].last_sector = df->size_sectors - 1;
+        df->parts[0].size_bytes = df->size_sectors * SECTOR_SIZE;
     }
 
     return df;
@@ -254,7 +306,8 @@ diskfile *df_open(const char *path)
 //!
 //! Creates MBR of type 'mbr' and the partition table on diskfile 'df'
 //! according to a NULL-terminated array of 'parts' specs (where only
-//! 'size_bytes' and 'type' must be specified)
+//! 'size_bytes' and 'type' must be specified). The table is written
+//! by this process, without parted.
 //!
 //! @param[in] df
 //! @param[in] type
@@ -273,26 +326,33 @@ diskfile *df_open(const char *path)
 int df_partition(diskfile * df, enum mbr_t type, diskpart parts[])
 {
     int i = 0;
+    s64 limit_sector = 0;
     s64 current_sector = 0;
     diskpart *p = NULL;
     diskpart *q = NULL;
 
-    if (type != MBR_MSDOS) {
-        LOGERROR("only partition type 'msdos' is supported\n");
+    if ((type != MBR_MSDOS) && (type != MBR_GPT)) {
+        LOGERROR("only partition types 'msdos' and 'gpt' are supported\n");
         return EUCA_ERROR;
     }
     df->mbr = type;
 
     df->nparts = 0;                    // ignore previous partitioning
-    current_sector = 63;               // the starting sector for 'msdos' MBRs
+    if (type == MBR_GPT) {
+        current_sector = GPT_FIRST_SECTOR;
+        limit_sector = df->size_sectors - 1 - GPT_TABLE_SECTORS;    // the backup table and header are at the end
+    } else {
+        current_sector = MBR_FIRST_SECTOR;
+        limit_sector = df->size_sectors;
+    }
     for (p = parts; ((p->size_bytes > 0) && (df->nparts < MAX_PARTS)); p++) {
         q = &(df->parts[df->nparts]);
         q->size_bytes = p->size_bytes;
         q->type = p->type;
         q->first_sector = current_sector;
         q->last_sector = current_sector + round_up_sec(p->size_bytes) / SECTOR_SIZE;    // round up to make sure all data fits
-        if (q->last_sector >= df->size_sectors) {
-            LOGERROR("out of space in disk for partition %d (sectors: last=%ld max=%ld)\n", df->nparts, q->last_sector, df->size_sectors);
+        if (q->last_sector >= limit_sector) {
+            LOGERROR("out of space in disk for partition %d (sectors: last=%ld max=%ld)\n", df->nparts, q->last_sector, limit_sector);
             goto error;
         }
         current_sector = q->last_sector + 1;
@@ -304,14 +364,18 @@ int df_partition(diskfile * df, enum mbr_t type, diskpart parts[])
         goto error;
     }
     // now, actually do it on disk
-    LOGINFO("adding MBR to disk file %s in sectors [0-62]\n", df->path);
-    if (diskutil_mbr(df->path, "msdos") != EUCA_OK)
-        goto error;
-
     for (i = 0; i < df->nparts; i++) {
         q = &(df->parts[i]);
         LOGINFO("adding partition %d to disk %s in sectors [%ld-%ld]\n", i, df->path, q->first_sector, q->last_sector);
-        if (diskutil_part(df->path, "primary", enum_diskpart_t_string(q->type), q->first_sector, q->last_sector) != EUCA_OK)
+    }
+
+    if (type == MBR_GPT) {
+        LOGINFO("adding GPT to disk file %s in sectors [0-%d] and [%ld-%ld]\n", df->path, GPT_TABLE_SECTORS + 1, limit_sector, (df->size_sectors - 1));
+        if (write_gpt(df) != EUCA_OK)
+            goto error;
+    } else {
+        LOGINFO("adding MBR to disk file %s in sectors [0-%d]\n", df->path, (MBR_FIRST_SECTOR - 1));
+        if (write_mbr(df) != EUCA_OK)
             goto error;
     }
 
@@ -362,27 +426,21 @@ int df_format(diskfile * df, const int part, const enum diskpart_t format)
         p->last_sector = df->size_sectors - 1;
     }
 
+    // the partition is written in place, so no loopback device is needed
     size_bytes = (p->last_sector - p->first_sector + 1) * SECTOR_SIZE;
-    if (diskutil_loop(df->path, p->first_sector * SECTOR_SIZE, p->lodev, sizeof(p->lodev)) != EUCA_OK) {
-        LOGERROR("failed to mount partition on loopback\n");
-        return EUCA_ERROR;
-    }
-
     LOGINFO("formating %s as '%s' on '%s'\n", part_str, enum_format_as_string(format), df->path);
     switch (format) {
     case PFORMAT_SWAP:
-        if (diskutil_mkswap(p->lodev, size_bytes) != EUCA_OK) {
+        if (write_swap(df->path, p->first_sector * SECTOR_SIZE, size_bytes) != EUCA_OK) {
             LOGERROR("failed to make swap space\n");
             ret = EUCA_ERROR;
-            goto unloop;
         }
         break;
 
     case PFORMAT_EXT3:
-        if (diskutil_mkfs(p->lodev, size_bytes) != EUCA_OK) {
-            LOGERROR("failed to make swap space\n");
+        if (write_ext3(df, p, size_bytes) != EUCA_OK) {
+            LOGERROR("failed to make file system\n");
             ret = EUCA_ERROR;
-            goto unloop;
         }
         break;
 
@@ -391,12 +449,6 @@ int df_format(diskfile * df, const int part, const enum diskpart_t format)
         break;
     }
 
-unloop:
-    if (diskutil_unloop(p->lodev) != EUCA_OK) {
-        LOGERROR("failed to detach loopback device (there may be a leak!)\n");
-        ret = EUCA_ERROR;
-    }
-
     return ret;
 }
 
@@ -436,18 +488,9 @@ int df_dd(diskfile * df, const int part, const char *path)
         p->last_sector = df->size_sectors - 1;
     }
 
-    if (diskutil_loop(df->path, p->first_sector * SECTOR_SIZE, p->lodev, sizeof(p->lodev)) != EUCA_OK) {
-        LOGERROR("failed to mount partition on loopback\n");
-        return EUCA_ERROR;
-    }
-    //! @TODO: experiment with block sizes?
-    if (diskutil_dd(path, p->lodev, SECTOR_SIZE, (p->last_sector - p->first_sector + 1)) != EUCA_OK) {
-        LOGERROR("failed to copy file '%s' to '%s'\n", path, p->lodev);
-        ret = EUCA_ERROR;
-    }
-
-    if (diskutil_unloop(p->lodev) != EUCA_OK) {
-        LOGERROR("failed to detach loopback device (there may be a leak!)\n");
+    // copied straight into the sectors of the partition, skipping the holes of the file
+    if (diskutil_copy(path, df->path, SECTOR_SIZE, (p->last_sector - p->first_sector + 1), p->first_sector, 0) != EUCA_OK) {
+        LOGERROR("failed to copy file '%s' to partition %d of '%s'\n", path, use_part, df->path);
         ret = EUCA_ERROR;
     }
 
@@ -609,6 +652,8 @@ enum mbr_t parse_mbr_t_enum(const char *s)
         val = MBR_NONE;
     else if (strcmp(lc, "msdos") == 0)
         val = MBR_MSDOS;
+    else if (strcmp(lc, "gpt") == 0)
+        val = MBR_GPT;
     else
         err("failed to parse '%s' as mbr type", lc);
     EUCA_FREE(lc);
@@ -739,3 +784,530 @@ enum pformat_t parse_pformat_t_enum(const char *s)
     EUCA_FREE(lc);
     return val;
 }
+
+//!
+//! Stores a 16-bit value in little-endian order, as on-disk structures have it
+//!
+//! @param[out] buf
+//! @param[in]  val
+//!
+static void put_le16(unsigned char *buf, u16 val)
+{
+    buf[0] = (val & 0xFF);
+    buf[1] = ((val >> 8) & 0xFF);
+}
+
+//!
+//! Stores a 32-bit value in little-endian order
+//!
+//! @param[out] buf
+//! @param[in]  val
+//!
+static void put_le32(unsigned char *buf, u32 val)
+{
+    put_le16(buf, (val & 0xFFFF));
+    put_le16(buf + 2, (val >> 16));
+}
+
+//!
+//! Stores a 64-bit value in little-endian order
+//!
+//! @param[out] buf
+//! @param[in]  val
+//!
+static void put_le64(unsigned char *buf, u64 val)
+{
+    put_le32(buf, (val & 0xFFFFFFFF));
+    put_le32(buf + 4, (val >> 32));
+}
+
+//!
+//! Reads a 32-bit value stored in little-endian order
+//!
+//! @param[in] buf
+//!
+//! @return The value
+//!
+static u32 get_le32(const unsigned char *buf)
+{
+    return (((u32) buf[0]) | (((u32) buf[1]) << 8) | (((u32) buf[2]) << 16) | (((u32) buf[3]) << 24));
+}
+
+//!
+//! Reads a 64-bit value stored in little-endian order
+//!
+//! @param[in] buf
+//!
+//! @return The value
+//!
+static u64 get_le64(const unsigned char *buf)
+{
+    return (((u64) get_le32(buf)) | (((u64) get_le32(buf + 4)) << 32));
+}
+
+//!
+//! Computes the CRC32 used by GPT headers and tables (the one of zlib and Ethernet)
+//!
+//! @param[in] buf
+//! @param[in] len
+//!
+//! @return The checksum
+//!
+static u32 crc32_gpt(const unsigned char *buf, size_t len)
+{
+    int bit = 0;
+    size_t i = 0;
+    u32 crc = 0xFFFFFFFF;
+
+    for (i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (bit = 0; bit < 8; bit++) {
+            crc = ((crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1));
+        }
+    }
+    return (crc ^ 0xFFFFFFFF);
+}
+
+//!
+//! Fills a buffer with random bytes, for disk identifiers and GUIDs
+//!
+//! @param[out] buf
+//! @param[in]  len
+//!
+static void random_bytes(unsigned char *buf, size_t len)
+{
+    int fd = -1;
+    size_t i = 0;
+
+    if (((fd = open("/dev/urandom", O_RDONLY)) >= 0) && (read(fd, buf, len) == ((ssize_t) len))) {
+        close(fd);
+        return;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    for (i = 0; i < len; i++) {
+        buf[i] = (rand() & 0xFF);
+    }
+}
+
+//!
+//! Converts a sector number into the cylinder/head/sector triplet of an MBR entry, for
+//! the 255 heads and 63 sectors per track that parted assumes as well
+//!
+//! @param[in]  lba
+//! @param[out] chs three bytes
+//!
+static void lba_to_chs(s64 lba, unsigned char *chs)
+{
+    s64 cylinder = 0;
+
+    if (lba >= (1024L * CHS_HEADS * CHS_SECTORS)) {    // beyond what CHS can address
+        chs[0] = 0xFE;
+        chs[1] = 0xFF;
+        chs[2] = 0xFF;
+        return;
+    }
+
+    cylinder = lba / (CHS_HEADS * CHS_SECTORS);
+    chs[0] = ((lba / CHS_SECTORS) % CHS_HEADS);
+    chs[1] = (((lba % CHS_SECTORS) + 1) | ((cylinder >> 2) & 0xC0));
+    chs[2] = (cylinder & 0xFF);
+}
+
+//!
+//! Fills out one of the four partition entries of an MBR
+//!
+//! @param[out] entry MBR_ENTRY_BYTES bytes
+//! @param[in]  id partition id
+//! @param[in]  first_sector
+//! @param[in]  last_sector
+//!
+static void put_mbr_entry(unsigned char *entry, u8 id, s64 first_sector, s64 last_sector)
+{
+    s64 sectors = last_sector - first_sector + 1;
+
+    entry[0] = 0x00;                   // not active, GRUB sets that if need be
+    lba_to_chs(first_sector, entry + 1);
+    entry[4] = id;
+    lba_to_chs(last_sector, entry + 5);
+    put_le32(entry + 8, ((first_sector > 0xFFFFFFFFL) ? 0xFFFFFFFF : first_sector));
+    put_le32(entry + 12, ((sectors > 0xFFFFFFFFL) ? 0xFFFFFFFF : sectors));
+}
+
+//!
+//! Fills out a GPT header, with its checksum
+//!
+//! @param[out] hdr a sector
+//! @param[in]  my_lba sector of this header
+//! @param[in]  alt_lba sector of the other header
+//! @param[in]  table_lba first sector of the partition entries this header describes
+//! @param[in]  last_lba last sector of the disk
+//! @param[in]  guid the disk GUID
+//! @param[in]  table_crc checksum of the partition entries
+//!
+static void put_gpt_header(unsigned char *hdr, s64 my_lba, s64 alt_lba, s64 table_lba, s64 last_lba, const unsigned char *guid, u32 table_crc)
+{
+    bzero(hdr, SECTOR_SIZE);
+    memcpy(hdr, GPT_SIGNATURE, 8);
+    put_le32(hdr + 8, GPT_REVISION);
+    put_le32(hdr + 12, GPT_HEADER_BYTES);
+    put_le64(hdr + 24, my_lba);
+    put_le64(hdr + 32, alt_lba);
+    put_le64(hdr + 40, 2 + GPT_TABLE_SECTORS);  // first usable sector
+    put_le64(hdr + 48, last_lba - 1 - GPT_TABLE_SECTORS);   // last usable sector
+    memcpy(hdr + 56, guid, 16);
+    put_le64(hdr + 72, table_lba);
+    put_le32(hdr + 80, GPT_ENTRIES);
+    put_le32(hdr + 84, GPT_ENTRY_BYTES);
+    put_le32(hdr + 88, table_crc);
+    put_le32(hdr + 16, crc32_gpt(hdr, GPT_HEADER_BYTES));
+}
+
+//!
+//! Writes whole sectors to a disk file
+//!
+//! @param[in] path
+//! @param[in] sector where to write
+//! @param[in] buf
+//! @param[in] sectors how many to write
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int write_sectors(const char *path, s64 sector, const unsigned char *buf, s64 sectors)
+{
+    int fd = -1;
+    ssize_t wrote = 0;
+    size_t done = 0;
+    size_t len = sectors * SECTOR_SIZE;
+
+    if ((fd = open(path, O_WRONLY)) < 0) {
+        LOGERROR("failed to open '%s': %s\n", path, strerror(errno));
+        return EUCA_ERROR;
+    }
+
+    while (done < len) {
+        if ((wrote = pwrite(fd, buf + done, len - done, (sector * SECTOR_SIZE) + done)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to write sector %ld of '%s': %s\n", (sector + (done / SECTOR_SIZE)), path, strerror(errno));
+            close(fd);
+            return EUCA_ERROR;
+        }
+        done += wrote;
+    }
+
+    if (fsync(fd)) {
+        LOGERROR("failed to flush '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return EUCA_ERROR;
+    }
+    close(fd);
+    return EUCA_OK;
+}
+
+//!
+//! Writes an 'msdos' MBR with the primary partitions of the disk file, as
+//! 'parted mklabel msdos' followed by 'parted mkpart primary' did
+//!
+//! @param[in] df
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int write_mbr(diskfile * df)
+{
+    int i = 0;
+    unsigned char mbr[SECTOR_SIZE] = { 0 };
+
+    if (df->nparts > MBR_MAX_ENTRIES) {
+        LOGERROR("an 'msdos' MBR holds at most %d partitions\n", MBR_MAX_ENTRIES);
+        return EUCA_ERROR;
+    }
+
+    random_bytes(mbr + MBR_DISK_ID_OFFSET, 4);
+    for (i = 0; i < df->nparts; i++) {
+        put_mbr_entry(mbr + MBR_TABLE_OFFSET + (i * MBR_ENTRY_BYTES), _mbr_ids[df->parts[i].type], df->parts[i].first_sector, df->parts[i].last_sector);
+    }
+    mbr[MBR_SIGNATURE_OFFSET] = 0x55;
+    mbr[MBR_SIGNATURE_OFFSET + 1] = 0xAA;
+
+    return write_sectors(df->path, 0, mbr, 1);
+}
+
+//!
+//! Writes a GPT with the partitions of the disk file: the protective MBR, the primary
+//! header and entries at the start of the disk and their backups at the end
+//!
+//! @param[in] df
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int write_gpt(diskfile * df)
+{
+    int i = 0;
+    int c = 0;
+    int ret = EUCA_ERROR;
+    u32 table_crc = 0;
+    s64 last_lba = df->size_sectors - 1;
+    unsigned char *e = NULL;
+    unsigned char *table = NULL;
+    unsigned char guid[16] = { 0 };
+    unsigned char mbr[SECTOR_SIZE] = { 0 };
+    unsigned char hdr[SECTOR_SIZE] = { 0 };
+    const char *name = "primary";
+
+    if ((table = EUCA_ZALLOC(GPT_TABLE_SECTORS, SECTOR_SIZE)) == NULL) {
+        LOGERROR("out of memory\n");
+        return EUCA_ERROR;
+    }
+
+    for (i = 0; i < df->nparts; i++) {
+        e = table + (i * GPT_ENTRY_BYTES);
+        memcpy(e, _gpt_types[df->parts[i].type], 16);
+        random_bytes(e + 16, 16);
+        e[16 + 7] = ((e[16 + 7] & 0x0F) | 0x40);    // a random (version 4) GUID
+        e[16 + 8] = ((e[16 + 8] & 0x3F) | 0x80);
+        put_le64(e + 32, df->parts[i].first_sector);
+        put_le64(e + 40, df->parts[i].last_sector);
+        for (c = 0; name[c] != '\0'; c++) {
+            put_le16(e + 56 + (2 * c), name[c]);
+        }
+    }
+    table_crc = crc32_gpt(table, GPT_ENTRIES * GPT_ENTRY_BYTES);
+
+    random_bytes(guid, sizeof(guid));
+    guid[7] = ((guid[7] & 0x0F) | 0x40);
+    guid[8] = ((guid[8] & 0x3F) | 0x80);
+
+    // the protective MBR makes the whole disk look used to tools that only know MBRs
+    put_mbr_entry(mbr + MBR_TABLE_OFFSET, MBR_ID_GPT, 1, last_lba);
+    mbr[MBR_SIGNATURE_OFFSET] = 0x55;
+    mbr[MBR_SIGNATURE_OFFSET + 1] = 0xAA;
+    if (write_sectors(df->path, 0, mbr, 1) != EUCA_OK)
+        goto out;
+
+    // backup first, so that a disk with a valid primary header is complete
+    if (write_sectors(df->path, last_lba - GPT_TABLE_SECTORS, table, GPT_TABLE_SECTORS) != EUCA_OK)
+        goto out;
+    put_gpt_header(hdr, last_lba, 1, last_lba - GPT_TABLE_SECTORS, last_lba, guid, table_crc);
+    if (write_sectors(df->path, last_lba, hdr, 1) != EUCA_OK)
+        goto out;
+
+    if (write_sectors(df->path, 2, table, GPT_TABLE_SECTORS) != EUCA_OK)
+        goto out;
+    put_gpt_header(hdr, 1, last_lba, 2, last_lba, guid, table_crc);
+    if (write_sectors(df->path, 1, hdr, 1) != EUCA_OK)
+        goto out;
+
+    ret = EUCA_OK;
+
+out:
+    EUCA_FREE(table);
+    return ret;
+}
+
+//!
+//! Reads the partitions of a GPT disk file from its primary header and entries
+//!
+//! @param[in] df
+//! @param[in] fd the disk file, open for reading
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the GPT is not valid
+//!
+static int read_gpt(diskfile * df, int fd)
+{
+    int i = 0;
+    int t = 0;
+    u32 entries = 0;
+    u32 entry_bytes = 0;
+    u32 crc = 0;
+    s64 first = 0;
+    s64 last = 0;
+    size_t table_bytes = 0;
+    unsigned char *e = NULL;
+    unsigned char *table = NULL;
+    unsigned char hdr[SECTOR_SIZE] = { 0 };
+    static const unsigned char unused[16] = { 0 };
+
+    if ((pread(fd, hdr, SECTOR_SIZE, SECTOR_SIZE) != SECTOR_SIZE) || memcmp(hdr, GPT_SIGNATURE, 8)) {
+        LOGERROR("no GPT header in '%s'\n", df->path);
+        return EUCA_ERROR;
+    }
+
+    crc = get_le32(hdr + 16);
+    put_le32(hdr + 16, 0);
+    entries = get_le32(hdr + 80);
+    entry_bytes = get_le32(hdr + 84);
+    table_bytes = ((size_t) entries) * entry_bytes;
+    if ((crc != crc32_gpt(hdr, GPT_HEADER_BYTES)) || (entry_bytes < GPT_ENTRY_BYTES) || (table_bytes > (GPT_ENTRIES * GPT_ENTRY_BYTES * 8))) {
+        LOGERROR("invalid GPT header in '%s'\n", df->path);
+        return EUCA_ERROR;
+    }
+
+    if ((table = EUCA_ALLOC(table_bytes, 1)) == NULL) {
+        LOGERROR("out of memory\n");
+        return EUCA_ERROR;
+    }
+
+    if ((pread(fd, table, table_bytes, get_le64(hdr + 72) * SECTOR_SIZE) != ((ssize_t) table_bytes)) || (crc32_gpt(table, table_bytes) != get_le32(hdr + 88))) {
+        LOGERROR("invalid GPT partition entries in '%s'\n", df->path);
+        EUCA_FREE(table);
+        return EUCA_ERROR;
+    }
+
+    for (i = 0; (i < entries) && (df->nparts < MAX_PARTS); i++) {
+        e = table + (i * entry_bytes);
+        if (!memcmp(e, unused, 16))
+            continue;
+
+        first = get_le64(e + 32);
+        last = get_le64(e + 40);
+        LOGINFO("partition %d: [%ld-%ld]\n", df->nparts, first, last);
+        df->parts[df->nparts].type = DISKPART_UNKNOWN;
+        for (t = 0; t < (sizeof(_gpt_types) / sizeof(_gpt_types[0])); t++) {
+            if ((t != DISKPART_UNKNOWN) && !memcmp(e, _gpt_types[t], 16))
+                df->parts[df->nparts].type = t;
+        }
+        df->parts[df->nparts].first_sector = first;
+        df->parts[df->nparts].last_sector = last;
+        df->parts[df->nparts].size_bytes = (last - first + 1) * SECTOR_SIZE;
+        df->nparts++;
+    }
+
+    df->mbr = MBR_GPT;
+    EUCA_FREE(table);
+    return EUCA_OK;
+}
+
+//!
+//! Discovers the partitions of a disk file from its 'msdos' MBR or its GPT, without
+//! running 'file'. A first sector that does not hold a valid partition table, as with
+//! an image of a single file system, leaves the disk file without partitions.
+//!
+//! @param[in] df
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the file cannot be read or has an invalid GPT
+//!
+static int read_partitions(diskfile * df)
+{
+    int i = 0;
+    int fd = -1;
+    int ret = EUCA_OK;
+    u8 id = 0;
+    s64 first = 0;
+    s64 sectors = 0;
+    unsigned char *e = NULL;
+    unsigned char mbr[SECTOR_SIZE] = { 0 };
+
+    df->nparts = 0;
+    if ((fd = open(df->path, O_RDONLY)) < 0) {
+        LOGERROR("failed to open '%s': %s\n", df->path, strerror(errno));
+        return EUCA_ERROR;
+    }
+
+    if (pread(fd, mbr, SECTOR_SIZE, 0) != SECTOR_SIZE) {
+        LOGERROR("failed to read the first sector of '%s'\n", df->path);
+        close(fd);
+        return EUCA_ERROR;
+    }
+
+    if ((mbr[MBR_SIGNATURE_OFFSET] != 0x55) || (mbr[MBR_SIGNATURE_OFFSET + 1] != 0xAA))
+        goto out;
+
+    if (mbr[MBR_TABLE_OFFSET + 4] == MBR_ID_GPT) {
+        ret = read_gpt(df, fd);
+        goto out;
+    }
+
+    for (i = 0; i < MBR_MAX_ENTRIES; i++) {
+        e = mbr + MBR_TABLE_OFFSET + (i * MBR_ENTRY_BYTES);
+        if ((id = e[4]) == 0)
+            continue;
+
+        first = get_le32(e + 8);
+        sectors = get_le32(e + 12);
+        if ((e[0] & 0x7F) || (first == 0) || (sectors == 0) || ((first + sectors) > df->size_sectors)) {
+            LOGDEBUG("first sector of '%s' is not a partition table\n", df->path);
+            df->nparts = 0;
+            goto out;
+        }
+
+        LOGINFO("partition %d: [%ld-%ld]\n", df->nparts, first, (first + sectors - 1));
+        df->parts[df->nparts].type = ((id == MBR_ID_SWAP) ? DISKPART_SWAP : ((id == MBR_ID_NTFS) ? DISKPART_WINDOWS : DISKPART_EXT234));
+        df->parts[df->nparts].first_sector = first;
+        df->parts[df->nparts].last_sector = first + sectors - 1;
+        df->parts[df->nparts].size_bytes = sectors * SECTOR_SIZE;
+        df->nparts++;
+    }
+
+    if (df->nparts > 0)
+        df->mbr = MBR_MSDOS;
+
+out:
+    close(fd);
+    return ret;
+}
+
+//!
+//! Writes the header of a Linux swap area (version 1, as mkswap makes them) at the
+//! start of a partition of a disk file
+//!
+//! @param[in] path the disk file
+//! @param[in] offset where the partition starts, in bytes
+//! @param[in] size_bytes size of the partition
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int write_swap(const char *path, s64 offset, s64 size_bytes)
+{
+    s64 pages = size_bytes / SWAP_PAGE_BYTES;
+    unsigned char page[SWAP_PAGE_BYTES] = { 0 };
+
+    if (pages < SWAP_MIN_PAGES) {
+        LOGERROR("swap space of %ld bytes is too small\n", size_bytes);
+        return EUCA_ERROR;
+    }
+
+    put_le32(page + SWAP_HEADER_OFFSET, 1);    // version
+    put_le32(page + SWAP_HEADER_OFFSET + 4, (pages - 1));   // last page
+    put_le32(page + SWAP_HEADER_OFFSET + 8, 0); // number of bad pages
+    random_bytes(page + SWAP_HEADER_OFFSET + 12, 16);   // UUID, followed by an empty label
+    page[SWAP_HEADER_OFFSET + 12 + 6] = ((page[SWAP_HEADER_OFFSET + 12 + 6] & 0x0F) | 0x40);
+    page[SWAP_HEADER_OFFSET + 12 + 8] = ((page[SWAP_HEADER_OFFSET + 12 + 8] & 0x3F) | 0x80);
+    memcpy(page + SWAP_PAGE_BYTES - strlen(SWAP_SIGNATURE), SWAP_SIGNATURE, strlen(SWAP_SIGNATURE));
+
+    return write_sectors(path, (offset / SECTOR_SIZE), page, (SWAP_PAGE_BYTES / SECTOR_SIZE));
+}
+
+//!
+//! Makes an ext3 file system in a partition of a disk file. The file system is made in a
+//! temporary file of the work directory, which mkfs can format without a loopback device
+//! or root privileges, and copied into the partition minus its holes.
+//!
+//! @param[in] df
+//! @param[in] p the partition
+//! @param[in] size_bytes size of the partition
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int write_ext3(diskfile * df, diskpart * p, s64 size_bytes)
+{
+    int ret = EUCA_ERROR;
+    char *tmp_path = NULL;
+
+    if ((tmp_path = alloc_tmp_file("ext3", size_bytes)) == NULL)
+        return EUCA_ERROR;
+
+    if (truncate(tmp_path, size_bytes)) {
+        LOGERROR("failed to size '%s': %s\n", tmp_path, strerror(errno));
+    } else if (diskutil_mkfs_file(tmp_path, size_bytes) != EUCA_OK) {
+        LOGERROR("failed to make ext3 file system in '%s'\n", tmp_path);
+    } else if (diskutil_copy(tmp_path, df->path, SECTOR_SIZE, (size_bytes / SECTOR_SIZE), p->first_sector, 0) != EUCA_OK) {
+        LOGERROR("failed to copy file system into '%s'\n", df->path);
+    } else {
+        ret = EUCA_OK;
+    }
+
+    FREE_TMP_FILE(tmp_path, size_bytes);
+    return ret;
+}
@@ -88,7 +88,8 @@ typedef struct _diskfile {
     s64 size_sectors;
     enum mbr_t {
         MBR_NONE = 0,
-        MBR_MSDOS
+        MBR_MSDOS,
+        MBR_GPT
     } mbr;
     diskpart parts[MAX_PARTS];
     int nparts;
@@ -36,8 +36,14 @@
 #include <unistd.h>                    // getopt
 #include <fcntl.h>                     // open
 #include <ctype.h>                     // tolower
+#include <limits.h>                    // LLONG_MAX
 #include <errno.h>                     // errno
+#include <signal.h>
+#include <poll.h>
 #include <sys/vfs.h>                   // statfs
+#include <sys/socket.h>
+#include <sys/un.h>                    // sockaddr_un
+#include <sys/wait.h>
 
 #include <eucalyptus.h>
 #include <euca_auth.h>
@@ -60,6 +66,13 @@
 #define MAX_REQS                                 32
 #define MAX_PARAMS                               32
 
+#define DEFAULT_SERVICE_JOBS                     4  //!< requests run at once by the service, unless jobs= is given
+#define MAX_SERVICE_JOBS                         64
+#define MAX_SERVICE_ARGS                         (MAX_REQS * (MAX_PARAMS + 1) + 16)
+#define SERVICE_REQUEST_BYTES                    65536
+#define SERVICE_POLL_MS                          250    //!< how often the service reaps finished requests
+#define SERVICE_EXIT_TAG                         "euca-imager-exit="    //!< last line sent back for each request
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -78,6 +91,13 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A request being run by the service
+typedef struct _service_job {
+    pid_t pid;                         //!< of the process running the request, 0 if the slot is free
+    int fd;                            //!< connection to the client, which receives the logs and the exit code
+    int seq;                           //!< number of the request since the service started, for logging
+} service_job;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -118,6 +138,14 @@ static boolean print_debug = FALSE;
 static boolean print_argv = FALSE;
 static boolean purge_cache = FALSE; // whether to clean out cache after work
 
+static char service_path[EUCA_MAX_PATH] = "";  //!< socket the service listens on, when listen= is given
+static int service_jobs = DEFAULT_SERVICE_JOBS;
+static boolean in_service = FALSE;     //!< set in the processes running requests for the service
+static boolean cache_checked = FALSE;  //!< whether the service checked the cache blobstore already
+static boolean work_given = FALSE;     //!< whether work= was given, otherwise each service request gets its own
+static boolean work_size_given = FALSE; //!< whether work_size= was given, otherwise service requests share it
+static volatile sig_atomic_t service_stop = 0;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -132,6 +160,11 @@ static imager_command *validate_cmd(int index, char *this_cmd, imager_param * pa
 static void set_global_parameter(char *key, char *val);
 static int stale_blob_examiner(const blockblob * bb);
 static int stat_blobstore(const char *path, blobstore * bs);
+static int run_request(char *argv[]);
+static void service_signal(int sig);
+static void run_service_request(int fd);
+static int serve_requests(void);
+static int send_request(const char *path, char *argv[]);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -196,6 +229,8 @@ static void usage(const char *msg)
         fprintf(stderr, "error: %s\n\n", msg);
 
     fprintf(stderr, "Usage: euca-imager [command param=value param2=value ...] [command2 ...]\n");
+    fprintf(stderr, "       euca-imager listen=socket [jobs=N] [param=value ...]\n");
+    fprintf(stderr, "       euca-imager connect=socket [command param=value param2=value ...] [command2 ...]\n");
 
     if (msg == NULL)
         fprintf(stderr, "Try 'euca-imager help' for list of commands\n");
@@ -341,8 +376,10 @@ static void set_global_parameter(char *key, char *val)
         print_argv = parse_boolean(val);
     } else if (strcmp(key, "work") == 0) {
         set_work_dir(val);
+        work_given = TRUE;
     } else if (strcmp(key, "work_size") == 0) {
         set_work_limit(parse_bytes(val));
+        work_size_given = TRUE;
     } else if (strcmp(key, "cache") == 0) {
         set_cache_dir(val);
     } else if (strcmp(key, "cache_size") == 0) {
@@ -353,6 +390,13 @@ static void set_global_parameter(char *key, char *val)
         euca_strncpy(cloud_cert_path, val, sizeof(cloud_cert_path));
     } else if (strcmp(key, "service_key") == 0) {
         euca_strncpy(service_key_path, val, sizeof(service_key_path));
+    } else if (strcmp(key, "listen") == 0) {
+        if (in_service)
+            err("requests sent to the service cannot set 'listen'");
+        euca_strncpy(service_path, val, sizeof(service_path));
+    } else if (strcmp(key, "jobs") == 0) {
+        if (((service_jobs = atoi(val)) < 1) || (service_jobs > MAX_SERVICE_JOBS))
+            err("'jobs' must be between 1 and %d", MAX_SERVICE_JOBS);
     } else {
         err("unknown global parameter '%s'", key);
     }
@@ -426,26 +470,19 @@ static int stat_blobstore(const char *path, blobstore * bs)
 int main(int argc, char *argv[])
 {
     int i = 0;
-    int ret = EUCA_OK;
-    int nparams = 0;
-    int ncmds = 0;
-    char *eq = NULL;
-    char *key = NULL;
-    char *val = NULL;
     char euca_root[] = "";
-    char argv_str[4096] = "";
-    char *cmd_name = NULL;
-    char pid_file[EUCA_MAX_PATH] = "";
-    FILE *fp = NULL;
-    pid_t pid = 0;
-    artifact *root = NULL;
-    blobstore *work_bs = NULL;
-    blobstore *cache_bs = NULL;
-    imager_param *cmd_params = NULL;
 
     log_fp_set(stderr); // imager logs to stderr so image data can be piped to stdout
     set_debug(print_debug);
 
+    // with connect=, the request is handed to a service started with listen=
+    for (i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "connect=", 8))
+            exit(send_request(argv[i] + 8, argv));
+        if (!strncmp(argv[i], "--connect=", 10))
+            exit(send_request(argv[i] + 10, argv));
+    }
+
     // initialize globals
     artifacts_map = map_create(10);
 
@@ -457,19 +494,51 @@ int main(int argc, char *argv[])
     snprintf(cloud_cert_path, EUCA_MAX_PATH, "%s/var/lib/eucalyptus/keys/cloud-cert.pem", euca_home);
     snprintf(service_key_path, EUCA_MAX_PATH, "%s/var/lib/eucalyptus/keys/node-pk.pem", euca_home);
 
+    // initialize dependencies
+    if (vmdk_init() == EUCA_OK) {
+        vddk_available = TRUE;
+    }
+
+    exit(run_request(argv));
+}
+
+//!
+//! Parses the parameters and commands of a request and carries it out, or starts the
+//! service when the parameters include listen=
+//!
+//! @param[in] argv the request, as on the command line, ending with a NULL
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int run_request(char *argv[])
+{
+    int i = 0;
+    int ret = EUCA_OK;
+    int nparams = 0;
+    int ncmds = 0;
+    char *eq = NULL;
+    char *key = NULL;
+    char *val = NULL;
+    char argv_str[4096] = "";
+    char *cmd_name = NULL;
+    char pid_file[EUCA_MAX_PATH] = "";
+    char work_dir[EUCA_MAX_PATH] = "";
+    FILE *fp = NULL;
+    pid_t pid = 0;
+    boolean do_fsck = FALSE;
+    artifact *root = NULL;
+    blobstore *work_bs = NULL;
+    blobstore *cache_bs = NULL;
+    imager_param *cmd_params = NULL;
+
     // save the command line into a buffer so it's easier to rerun it by hand
     argv_str[0] = '\0';
-    for (i = 0; i < argc; i++) {
+    for (i = 0; argv[i] != NULL; i++) {
         strncat(argv_str, "\"", sizeof(argv_str) - strlen(argv_str) - 1);
         strncat(argv_str, argv[i], sizeof(argv_str) - strlen(argv_str) - 1);
         strncat(argv_str, "\" ", sizeof(argv_str) - strlen(argv_str) - 1);
     }
 
-    // initialize dependencies
-    if (vmdk_init() == EUCA_OK) {
-        vddk_available = TRUE;
-    }
-
     // parse command-line parameters
     while (*(++argv)) {
         eq = strstr(*argv, "=");       // all params have '='s
@@ -521,6 +590,24 @@ int main(int argc, char *argv[])
         }
     }
 
+    if ((service_path[0] != '\0') && !in_service) {
+        if (cmd_name != NULL)
+            err("commands cannot be given along with 'listen'");
+        return serve_requests();
+    }
+
+    if (in_service) {
+        // requests running side by side each get a directory and a share of the work space
+        if (!work_given) {
+            snprintf(work_dir, sizeof(work_dir), "%s/request-%d", get_work_dir(), getpid());
+            if (set_work_dir(work_dir) != EUCA_OK)
+                err("failed to create work directory %s", work_dir);
+        }
+        if (!work_size_given && (get_work_limit() < LLONG_MAX)) {
+            set_work_limit(get_work_limit() / service_jobs);
+        }
+    }
+
     if (imaging_init(euca_home, cloud_cert_path, service_key_path)) {
         err("failed to find required dependencies for image work\n");
     }
@@ -545,6 +632,8 @@ int main(int argc, char *argv[])
     // invoke the requirements checkers in the same order as on command line,
     // constructing the artifact tree originating at 'root'
     for (i = 0; i < ncmds; i++) {
+        if (strcmp(reqs[i].cmd->name, "fsck") == 0)
+            do_fsck = TRUE;            // the stores get checked together below, rather than one after the other
         if (reqs[i].cmd->requirements != NULL) {
             art_set_instanceId(reqs[i].cmd->name);  // for logging
             if ((root = reqs[i].cmd->requirements(&reqs[i], root)) == NULL) // pass results of earlier checkers to later checkers
@@ -579,12 +668,16 @@ int main(int argc, char *argv[])
             err("failed to open cache blobstore: %s\n", blobstore_get_error_str(blobstore_get_error()));
         }
 
-        if (blobstore_fsck(cache_bs, NULL)) //! @TODO: verify checksums?
+        // the service checked it on startup, and requests running next to each other must not fsck it
+        if (!do_fsck && !cache_checked && blobstore_fsck(cache_bs, NULL))   //! @TODO: verify checksums?
             err("cache blobstore failed integrity check: %s", blobstore_get_error_str(blobstore_get_error()));
-
-        if (stat_blobstore(get_cache_dir(), cache_bs))
-            err("blobstore is unreadable");
     }
+
+    if (do_fsck && (fsck_blobstores(work_bs, stale_blob_examiner, cache_bs) != EUCA_OK))
+        err("blobstores failed integrity check");
+
+    if (cache_bs && stat_blobstore(get_cache_dir(), cache_bs))
+        err("blobstore is unreadable");
     // implement the artifact tree
     ret = EUCA_OK;
     if (root) {
@@ -623,7 +716,296 @@ int main(int argc, char *argv[])
     // indicate completion
     LOGINFO("imager done (exit code=%d)\n", ret);
 
-    exit(ret);
+    return ret;
+}
+
+//!
+//! Signal handler of the service, which stops taking requests and exits once the
+//! requests it is running are done
+//!
+//! @param[in] sig the signal received
+//!
+static void service_signal(int sig)
+{
+    service_stop = 1;
+}
+
+//!
+//! Runs one request received by the service, in a process of its own. The client sends
+//! the arguments of the request, as on the command line and including argv[0], each one
+//! terminated by a NUL, followed by an empty argument. The logs of the request are sent
+//! back on the same connection.
+//!
+//! @param[in] fd the connection to the client
+//!
+static void run_service_request(int fd)
+{
+    int nargs = 0;
+    int null_fd = -1;
+    size_t len = 0;
+    ssize_t got = 0;
+    char *p = NULL;
+    char *args[MAX_SERVICE_ARGS + 1] = { NULL };
+    static char buf[SERVICE_REQUEST_BYTES] = "";
+
+    in_service = TRUE;
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    while (len < sizeof(buf)) {
+        if ((got = read(fd, buf + len, sizeof(buf) - len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (got == 0)
+            break;
+        len += got;
+        if ((len >= 2) && (buf[len - 1] == '\0') && (buf[len - 2] == '\0'))
+            break;
+    }
+
+    if ((len < 2) || (buf[len - 1] != '\0') || (buf[len - 2] != '\0')) {
+        LOGERROR("incomplete or oversized request received by the service\n");
+        exit(1);
+    }
+
+    for (p = buf; (*p != '\0') && (nargs < MAX_SERVICE_ARGS); p += strlen(p) + 1) {
+        args[nargs++] = p;
+    }
+    args[nargs] = NULL;
+
+    if (*p != '\0') {
+        LOGERROR("too many arguments in request (max is %d)\n", MAX_SERVICE_ARGS);
+        exit(1);
+    }
+    // logs go to the client, and image data may not go through stdin or stdout
+    dup2(fd, STDERR_FILENO);
+    if ((null_fd = open("/dev/null", O_RDWR)) >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+    close(fd);
+
+    exit(run_request(args));
+}
+
+//!
+//! Runs the imager as a service, which takes requests on a local socket and runs up to
+//! service_jobs of them at once, each in a process forked from this one. The helpers,
+//! the settings and the check of the cache blobstore are done once here rather than
+//! for every request.
+//!
+//! @return EUCA_OK once stopped by SIGTERM or SIGINT. On failure the call to err() will
+//!         terminate the application.
+//!
+//! @see run_service_request(), send_request()
+//!
+static int serve_requests(void)
+{
+    int i = 0;
+    int fd = -1;
+    int conn = -1;
+    int code = 0;
+    int seq = 0;
+    int status = 0;
+    int running = 0;
+    pid_t pid = 0;
+    char line[64] = "";
+    blobstore *cache_bs = NULL;
+    service_job jobs[MAX_SERVICE_JOBS] = { {0} };
+    struct pollfd pfd = { 0 };
+    struct sigaction act = { {0} };
+    struct sockaddr_un addr = { 0 };
+
+    if (imaging_init(euca_home, cloud_cert_path, service_key_path)) {
+        err("failed to find required dependencies for image work\n");
+    }
+    // look for the helpers now, rather than in every request
+    if (diskutil_init(FALSE)) {
+        LOGWARN("some helpers are missing, requests needing them will fail\n");
+    }
+    // check the cache once, so that requests do not check it while others are using it
+    blobstore_set_error_function(&bs_errors);
+    if (ensure_directories_exist(get_cache_dir(), 0, NULL, NULL, BLOBSTORE_DIRECTORY_PERM) == -1) {
+        LOGWARN("failed to open or create cache directory %s\n", get_cache_dir());
+    } else if ((cache_bs = blobstore_open(get_cache_dir(), get_cache_limit() / 512, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU,
+                                          BLOBSTORE_SNAPSHOT_ANY)) == NULL) {
+        LOGWARN("failed to open cache blobstore: %s\n", blobstore_get_error_str(blobstore_get_error()));
+    } else {
+        if (blobstore_fsck(cache_bs, NULL))
+            err("cache blobstore failed integrity check: %s", blobstore_get_error_str(blobstore_get_error()));
+        stat_blobstore(get_cache_dir(), cache_bs);
+        blobstore_close(cache_bs);
+        cache_checked = TRUE;
+    }
+
+    if (strlen(service_path) >= sizeof(addr.sun_path))
+        err("socket path '%s' is too long", service_path);
+    addr.sun_family = AF_UNIX;
+    euca_strncpy(addr.sun_path, service_path, sizeof(addr.sun_path));
+
+    unlink(service_path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        err("failed to create socket: %s", strerror(errno));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || chmod(service_path, 0600) || listen(fd, MAX_SERVICE_JOBS))
+        err("failed to listen on '%s': %s", service_path, strerror(errno));
+
+    signal(SIGPIPE, SIG_IGN);
+    act.sa_handler = service_signal;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT, &act, NULL);
+
+    LOGINFO("imager service listening on %s for up to %d requests at once\n", service_path, service_jobs);
+    while (!service_stop || (running > 0)) {
+        // report on the requests that are done
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (i = 0; i < service_jobs; i++) {
+                if (jobs[i].pid == pid) {
+                    code = WIFEXITED(status) ? WEXITSTATUS(status) : (128 + WTERMSIG(status));
+                    LOGINFO("request %d done (exit code=%d)\n", jobs[i].seq, code);
+                    snprintf(line, sizeof(line), "%s%d\n", SERVICE_EXIT_TAG, code);
+                    if (write(jobs[i].fd, line, strlen(line)) < 0)
+                        LOGWARN("failed to report on request %d: %s\n", jobs[i].seq, strerror(errno));
+                    close(jobs[i].fd);
+                    jobs[i].pid = 0;
+                    running--;
+                    break;
+                }
+            }
+        }
+
+        // wait for a free slot before taking another request
+        if (service_stop || (running >= service_jobs)) {
+            poll(NULL, 0, SERVICE_POLL_MS);
+            continue;
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, SERVICE_POLL_MS) <= 0)
+            continue;
+
+        if ((conn = accept(fd, NULL, NULL)) < 0) {
+            if (errno != EINTR)
+                LOGWARN("failed to accept a request: %s\n", strerror(errno));
+            continue;
+        }
+
+        for (i = 0; (i < service_jobs) && (jobs[i].pid != 0); i++) ;
+        seq++;
+        if ((pid = fork()) == 0) {
+            close(fd);
+            for (i = 0; i < service_jobs; i++) {
+                if (jobs[i].pid != 0)
+                    close(jobs[i].fd);
+            }
+            run_service_request(conn);
+        }
+
+        if (pid < 0) {
+            LOGERROR("failed to start request %d: %s\n", seq, strerror(errno));
+            snprintf(line, sizeof(line), "%s%d\n", SERVICE_EXIT_TAG, EUCA_ERROR);
+            if (write(conn, line, strlen(line)) < 0)
+                LOGWARN("failed to report on request %d: %s\n", seq, strerror(errno));
+            close(conn);
+            continue;
+        }
+
+        LOGINFO("request %d started (pid=%d)\n", seq, pid);
+        jobs[i].pid = pid;
+        jobs[i].fd = conn;
+        jobs[i].seq = seq;
+        running++;
+    }
+
+    close(fd);
+    unlink(service_path);
+    LOGINFO("imager service stopped after %d request(s)\n", seq);
+    return EUCA_OK;
+}
+
+//!
+//! Hands a request to the service listening on a socket, relays its logs to stderr and
+//! returns its exit code, so that calling the imager with connect= behaves like calling
+//! it without
+//!
+//! @param[in] path the socket of the service
+//! @param[in] argv the request, as on the command line, where connect= is skipped
+//!
+//! @return The exit code of the request, or EUCA_ERROR if the service could not run it
+//!
+//! @see serve_requests()
+//!
+static int send_request(const char *path, char *argv[])
+{
+    int i = 0;
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    size_t len = 0;
+    size_t left = 0;
+    ssize_t got = 0;
+    const char *p = NULL;
+    char buf[4096] = "";
+    char line[4096] = "";
+    struct sockaddr_un addr = { 0 };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOGERROR("socket path '%s' is too long\n", path);
+        return EUCA_ERROR;
+    }
+    addr.sun_family = AF_UNIX;
+    euca_strncpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+    if (((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        LOGERROR("failed to connect to the imager service on '%s': %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return EUCA_ERROR;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for (i = 0; argv[i] != NULL; i++) {
+        if ((i > 0) && (!strncmp(argv[i], "connect=", 8) || !strncmp(argv[i], "--connect=", 10)))
+            continue;
+
+        for (p = argv[i], left = strlen(argv[i]) + 1; left > 0; p += got, left -= got) {
+            if ((got = write(fd, p, left)) < 0) {
+                LOGERROR("failed to send the request to '%s': %s\n", path, strerror(errno));
+                close(fd);
+                return EUCA_ERROR;
+            }
+        }
+    }
+    if ((write(fd, "", 1) != 1) || shutdown(fd, SHUT_WR)) {
+        LOGERROR("failed to send the request to '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return EUCA_ERROR;
+    }
+    // relay the logs, looking for the line with the exit code
+    while (((got = read(fd, buf, sizeof(buf))) > 0) || ((got < 0) && (errno == EINTR))) {
+        for (i = 0; i < got; i++) {
+            line[len++] = buf[i];
+            if ((buf[i] == '\n') || (len == (sizeof(line) - 1))) {
+                line[len] = '\0';
+                if (!strncmp(line, SERVICE_EXIT_TAG, strlen(SERVICE_EXIT_TAG))) {
+                    ret = atoi(line + strlen(SERVICE_EXIT_TAG));
+                } else {
+                    fputs(line, stderr);
+                }
+                len = 0;
+            }
+        }
+    }
+    if (len > 0) {
+        line[len] = '\0';
+        fputs(line, stderr);
+    }
+
+    close(fd);
+    return ret;
 }
 
 //!
@@ -30,6 +30,7 @@
 \*----------------------------------------------------------------------------*/
 
 #define _FILE_OFFSET_BITS 64           // so large-file support works on 32-bit systems
+#define _GNU_SOURCE                    // fallocate
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -67,6 +68,7 @@
 #define STDOUT                                      1 // @TODO what's the standard constant?
 #define MIN_VDDK_SIZE_BYTES                   1049600 // 1MB is minimum, apparently
 #define PROGRESS_UPDATE_SEC                         2 // how often we report on upload/download progress
+#define ZERO_CHUNK_SECTORS                        128 // granularity, 64KB, at which zeroes are detected and skipped
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -132,6 +134,9 @@ static int open_connection(vix_session * s, const img_spec * spec);
 static int open_disk(vix_session * s, const img_spec * spec);
 static int open_disk_local(vix_session * s, const char *path);
 static void cleanup(vix_session * s);
+static boolean is_zero(const u8 * buf, size_t len);
+static s64 skip_hole(int fd, s64 offset, s64 limit);
+static VixError write_nonzero(vix_session * s, VixDiskLibSectorType sector, const u8 * buf, long sectors, s64 * zero_sectors);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -542,6 +547,89 @@ out:
     return ret;
 }
 
+//!
+//! Tells whether a buffer holds nothing but zeroes, by comparing it with itself shifted by
+//! a byte, which lets memcmp() scan it a vector at a time
+//!
+//! @param[in] buf
+//! @param[in] len
+//!
+//! @return TRUE if all bytes are zero or FALSE otherwise
+//!
+static boolean is_zero(const u8 * buf, size_t len)
+{
+    return ((len == 0) || ((buf[0] == 0) && !memcmp(buf, buf + 1, len - 1)));
+}
+
+//!
+//! Moves the position in a local file past the hole that may start at 'offset', so that it
+//! is not read. The sector that the hole ends in is not skipped.
+//!
+//! @param[in] fd the file
+//! @param[in] offset current position, at a sector boundary
+//! @param[in] limit where the part of the file of interest ends
+//!
+//! @return the new position, 'offset' if there is no hole or the file system cannot tell,
+//!         or -1 if the file cannot be positioned
+//!
+static s64 skip_hole(int fd, s64 offset, s64 limit)
+{
+    off_t data = offset;
+
+#ifdef SEEK_DATA
+    if ((data = lseek(fd, offset, SEEK_DATA)) < 0) {
+        // ENXIO means there is no data past this point, anything else means no hole support
+        data = ((errno == ENXIO) ? limit : offset);
+    }
+#endif /* SEEK_DATA */
+    data = MIN(data, limit);
+    data -= (data % VIXDISKLIB_SECTOR_SIZE);
+    data = MAX(data, offset);
+    if (lseek(fd, data, SEEK_SET) < 0)
+        return (-1);
+    return (data);
+}
+
+//!
+//! Writes the ZERO_CHUNK_SECTORS chunks of a buffer that are not all zeroes to the remote
+//! disk, neighbors in a single write, and counts the sectors of the others, which are left
+//! as they are on the disk
+//!
+//! @param[in]     s the session
+//! @param[in]     sector where the buffer goes on the disk
+//! @param[in]     buf the data
+//! @param[in]     sectors size of the buffer, in sectors
+//! @param[in,out] zero_sectors incremented by the number of sectors skipped
+//!
+//! @return the result of VixDiskLib_Write()
+//!
+static VixError write_nonzero(vix_session * s, VixDiskLibSectorType sector, const u8 * buf, long sectors, s64 * zero_sectors)
+{
+    long i = 0;
+    long n = 0;
+    long run = -1;                     // first sector of the data being accumulated, if any
+    VixError error = VIX_OK;
+
+    for (i = 0; (i < sectors) && (error == VIX_OK); i += n) {
+        n = MIN(ZERO_CHUNK_SECTORS, (sectors - i));
+        if (!is_zero(buf + (i * VIXDISKLIB_SECTOR_SIZE), (n * VIXDISKLIB_SECTOR_SIZE))) {
+            if (run < 0)
+                run = i;
+            continue;
+        }
+
+        *zero_sectors += n;
+        if (run >= 0) {
+            error = VixDiskLib_Write(s->diskHandle, (sector + run), (i - run), buf + (run * VIXDISKLIB_SECTOR_SIZE));
+            run = -1;
+        }
+    }
+
+    if ((error == VIX_OK) && (run >= 0))
+        error = VixDiskLib_Write(s->diskHandle, (sector + run), (sectors - run), buf + (run * VIXDISKLIB_SECTOR_SIZE));
+    return (error);
+}
+
 //!
 //! Converts a local raw disk file or stream into remove VMDK
 //!
@@ -561,9 +649,11 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
     s64 vddk_bytes = 0;
     s64 true_bytes = 0;
     s64 zero_sectors = 0;
+    s64 hole_sectors = 0;
     long long bytes_written = 0LL;
     long sector = 0L;
     int fp = -1;
+    boolean sparse = FALSE;
     VixError vixError = VIX_OK;
     vix_session s = { 0 };
     VixDiskLibInfo *info = NULL;
@@ -587,6 +677,11 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
             LOGERROR("failed to open input path: %s\n", strerror(errno));
             return ret;
         }
+        if (fstat(fp, &mystat) != 0) {
+            LOGERROR("failed to stat input path: %s\n", strerror(errno));
+            close(fp);
+            return ret;
+        }
         if (S_ISBLK(mystat.st_mode)) {
             if (ioctl(fp, BLKGETSIZE64, &true_bytes) != 0) {
                 LOGERROR("input: failed to ioctl() device %s\n", disk_path);
@@ -601,6 +696,7 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
             fs_bytes = (s64) (mystat.st_blocks * mystat.st_blksize);
             fs_blocks = (s64) mystat.st_blocks;
             fs_blocksize = (int)mystat.st_blksize;
+            sparse = TRUE;             // its holes need not be read
         } else {
             LOGERROR("input: invalid path (neither regular file nor block device): %s\n", disk_path);
             close(fp);
@@ -651,6 +747,11 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
             end_sector = vddk_blocks - 1;
         }
     }
+    // a window that does not start at the beginning, e.g., a stripe of a parallel conversion
+    if ((start_sector > 0) && (fp != STDIN) && (lseek(fp, (start_sector * VIXDISKLIB_SECTOR_SIZE), SEEK_SET) < 0)) {
+        LOGERROR("failed to seek to sector %lld of '%s': %s\n", start_sector, disk_path, strerror(errno));
+        goto out;
+    }
 
     time_t before = time(NULL);
     {
@@ -672,10 +773,28 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
 
             boolean eof = FALSE;
             long buf_offset = 0;
+
+            // skip the hole of a sparse input file, if we are at one, without reading it
+            if (sparse) {
+                s64 offset = ((s64) sector) * VIXDISKLIB_SECTOR_SIZE;
+                s64 data = skip_hole(fp, offset, MIN(true_bytes, ((s64) end_sector + 1) * VIXDISKLIB_SECTOR_SIZE));
+                if (data < 0) {
+                    LOGERROR("failed to seek in input file %s: %s\n", disk_path, strerror(errno));
+                    break;
+                }
+                if (data > offset) {
+                    sectors_written = ((data - offset) / VIXDISKLIB_SECTOR_SIZE);
+                    hole_sectors += sectors_written;
+                    zero_sectors += sectors_written;
+                    bytes_written += VIXDISKLIB_SECTOR_SIZE * sectors_written;
+                    continue;
+                }
+            }
+
             do { // until we fill the buffer or reach EOF or get an error
-                long long t_before_read = time_usec();
+                long long t_before_read = mono_time_usec();
                 ssize_t bytes_read = read(fp, buf + buf_offset, buf_size_bytes - buf_offset);
-                long long t_after_read = time_usec();
+                long long t_after_read = mono_time_usec();
                 t_spent_reading += (t_after_read - t_before_read);
 
                 if (bytes_read > 0) {
@@ -702,38 +821,26 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
                 buf_offset = rounded_offset;
             }
 
-            // scan for all zeros
-            boolean all_zeros = TRUE;
-            for (int i = 0; i < buf_offset; i++) {
-                if (buf[i] != 0) {
-                    all_zeros = FALSE;
-                    break;
-                }
-            }
-
             // write as many sectors as are allowed by the [start, end] window
             sectors_written = buf_offset / VIXDISKLIB_SECTOR_SIZE;
             long sectors_left = end_sector - sector + 1;
             if (end_sector > 0 // a window with start and end was requested
-                && sectors_left > sectors_written) {
+                && sectors_left < sectors_written) {
                 sectors_written = sectors_left;
             }
-            if (!all_zeros) {
-                long long t_before_write = time_usec();
-                vixError = VixDiskLib_Write(s.diskHandle, sector, sectors_written, buf);
-                long long t_after_write = time_usec();
-                CHECK_ERROR();
-                t_spent_writing += (t_after_write - t_before_write);
-            } else {
-                zero_sectors += sectors_written;
-            }
+            long long t_before_write = mono_time_usec();
+            vixError = write_nonzero(&s, sector, buf, sectors_written, &zero_sectors);
+            long long t_after_write = mono_time_usec();
+            CHECK_ERROR();
+            t_spent_writing += (t_after_write - t_before_write);
             bytes_written += VIXDISKLIB_SECTOR_SIZE * sectors_written;
 
             // periodic message
             time_t now = time(NULL);
             if ((last_update + PROGRESS_UPDATE_SEC) <= now) {
-                LOGDEBUG("wrote sect %ld, zeros=%ld, [%lld-%lld], bytes_written=%lld\n",
-                         sector, zero_sectors, start_sector, end_sector, bytes_written);
+                LOGDEBUG("wrote sect %ld, zeros=%ld (holes=%ld), [%lld-%lld], bytes_written=%lld, skipped %d%%\n",
+                         sector, zero_sectors, hole_sectors, start_sector, end_sector, bytes_written,
+                         (int)((bytes_written > 0) ? ((zero_sectors * VIXDISKLIB_SECTOR_SIZE * 100) / bytes_written) : 0));
                 LOGDEBUG("reads took %lld usec, writes took %lld usec\n", t_spent_reading, t_spent_writing);
                 t_spent_reading = 0LL;
                 t_spent_writing = 0LL;
@@ -747,11 +854,12 @@ int vmdk_convert_to_remote(const char *disk_path, const img_spec * spec, long lo
     }
 
     time_t after = time(NULL);
-    LOGINFO("copy of %lldMB-disk took %d seconds (zero sectors=%ld/%lld)\n",
+    LOGINFO("copy of %lldMB-disk took %d seconds (zero sectors=%ld/%lld, of which %ld in holes, not transferred)\n",
             bytes_written / 1000000,
             (int)(after - before),
             zero_sectors,
-            bytes_written / VIXDISKLIB_SECTOR_SIZE);
+            bytes_written / VIXDISKLIB_SECTOR_SIZE,
+            hole_sectors);
 
     ret = EUCA_OK;
 
@@ -775,8 +883,12 @@ out:
 //!
 int vmdk_convert_from_remote(const img_spec * spec, const char *disk_path, long long start_sector, long long end_sector, long buf_size_bytes)
 {
-    u8 buf[VIXDISKLIB_SECTOR_SIZE] = { 0 };
-    int i = 0;
+    u8 *buf = NULL;
+    u8 *chunk = NULL;
+    long i = 0;
+    long n = 0;
+    long count = 0;
+    long buf_sectors = 0;
     int fp = -1;
     int ret = EUCA_ERROR;
     int percent = 0;
@@ -791,6 +903,7 @@ int vmdk_convert_from_remote(const img_spec * spec, const char *disk_path, long
     time_t before = 0;
     time_t timestamp = 0;
     boolean all_zeros = TRUE;
+    boolean punch = FALSE;
     struct stat mystat = { 0 };
     VixError vixError = VIX_OK;
     vix_session s = { 0 };
@@ -800,9 +913,15 @@ int vmdk_convert_from_remote(const img_spec * spec, const char *disk_path, long
     if (strcmp(disk_path, "-") == 0) {
         fp = STDOUT; // stdout
     } else {
+        // a window of the disk, e.g., a stripe of a parallel conversion, may be
+        // written into a file that the caller has already created, where the zeroes
+        // cannot simply be skipped over and holes are punched instead
         if (stat(disk_path, &mystat) == 0) {
-            LOGERROR("output file '%s' exists", disk_path);
-            return EUCA_ERROR;
+            if ((start_sector == 0) && (end_sector == 0)) {
+                LOGERROR("output file '%s' exists", disk_path);
+                return EUCA_ERROR;
+            }
+            punch = S_ISREG(mystat.st_mode);
         }
         //! @TODO are these perms ok?
         if ((fp = open(disk_path, O_CREAT | O_WRONLY, 0600)) < 0) {
@@ -821,7 +940,7 @@ int vmdk_convert_from_remote(const img_spec * spec, const char *disk_path, long
     vixError = VixDiskLib_GetInfo(s.diskHandle, &info);
     CHECK_ERROR();
 
-    // read the disk, sector at a time
+    // read the disk, a buffer at a time
     before = time(NULL);
     zero_sectors = 0;
     vddk_blocks = info->capacity;
@@ -845,55 +964,80 @@ int vmdk_convert_from_remote(const img_spec * spec, const char *disk_path, long
     if (end_sector == 0) { // 0 is special value meaning the whole disk
         end_sector = vddk_blocks - 1;
     }
+    if ((start_sector > 0) && (fp != STDOUT) && (lseek(fp, (start_sector * VIXDISKLIB_SECTOR_SIZE), SEEK_SET) < 0)) {
+        LOGERROR("failed to seek to sector %lld of '%s', giving up", start_sector, disk_path);
+        goto out;
+    }
 
-    for (sector = start_sector; sector <= end_sector; sector++) {
-        vixError = VixDiskLib_Read(s.diskHandle, sector, 1, buf);
-        CHECK_ERROR();
-
-        // scan for all zeros unless this is the last sector
-        if (sector == vddk_blocks - 1) {
-            all_zeros = FALSE;
-        } else {
-            for (all_zeros = TRUE, i = 0; i < VIXDISKLIB_SECTOR_SIZE; i++) {
-                if (buf[i] != 0) {
-                    all_zeros = FALSE;
-                    break;
-                }
-            }
-        }
+    // round-off buffer size to the multiple of sectors
+    buf_sectors = MAX(1, (buf_size_bytes / VIXDISKLIB_SECTOR_SIZE));
+    if ((buf = EUCA_ALLOC(buf_sectors, VIXDISKLIB_SECTOR_SIZE)) == NULL) {
+        LOGERROR("failed to allocate transfer buffer of size %ld\n", (buf_sectors * VIXDISKLIB_SECTOR_SIZE));
+        goto out;
+    }
 
-        bytes_scanned += VIXDISKLIB_SECTOR_SIZE;
+    for (sector = start_sector; sector <= end_sector; sector += count) {
+        count = MIN(buf_sectors, (end_sector - sector + 1));
+        vixError = VixDiskLib_Read(s.diskHandle, sector, count, buf);
+        CHECK_ERROR();
 
-        if (all_zeros && (fp != STDOUT)) {
-            if (lseek(fp, VIXDISKLIB_SECTOR_SIZE, SEEK_CUR) < 0) {
-                LOGERROR("failed to seek by a sector in '%s', giving up", disk_path);
-                goto out;
+        // skip over the chunks of zeroes, leaving holes in the file, unless writing to a stream
+        for (i = 0; i < count; i += n) {
+            n = MIN(ZERO_CHUNK_SECTORS, (count - i));
+            chunk = buf + (i * VIXDISKLIB_SECTOR_SIZE);
+            all_zeros = ((fp != STDOUT) && is_zero(chunk, (n * VIXDISKLIB_SECTOR_SIZE)));
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+            if (all_zeros && punch
+                && (fallocate(fp, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, ((sector + i) * VIXDISKLIB_SECTOR_SIZE), (n * VIXDISKLIB_SECTOR_SIZE)) != 0)) {
+                LOGDEBUG("cannot punch holes in '%s' (%s), writing the zeroes\n", disk_path, strerror(errno));
+                punch = FALSE;
+                all_zeros = FALSE;
             }
+#else /* FALLOC_FL_PUNCH_HOLE */
+            if (punch)
+                all_zeros = FALSE;
+#endif /* FALLOC_FL_PUNCH_HOLE */
 
-            bytes_zero += VIXDISKLIB_SECTOR_SIZE;
-            zero_sectors++;
-        } else {
-            if ((bytes = write(fp, buf, VIXDISKLIB_SECTOR_SIZE)) != VIXDISKLIB_SECTOR_SIZE) {
-                LOGERROR("failed to write a sector in '%s', giving up", disk_path);
+            if (all_zeros) {
+                if (lseek(fp, (n * VIXDISKLIB_SECTOR_SIZE), SEEK_CUR) < 0) {
+                    LOGERROR("failed to seek by %ld sectors in '%s', giving up", n, disk_path);
+                    goto out;
+                }
+                bytes_zero += (n * VIXDISKLIB_SECTOR_SIZE);
+                zero_sectors += n;
+            } else if ((bytes = write(fp, chunk, (n * VIXDISKLIB_SECTOR_SIZE))) != (n * VIXDISKLIB_SECTOR_SIZE)) {
+                LOGERROR("failed to write %ld sectors in '%s', giving up", n, disk_path);
                 goto out;
             }
         }
 
+        bytes_scanned += (count * VIXDISKLIB_SECTOR_SIZE);
+
         // progress printer
         now = time(NULL);
         if ((now - timestamp) > 10) {
             timestamp = now;
             percent = (int)((bytes_scanned * 100) / vddk_bytes);
-            LOGDEBUG("transfer progress %ld/%ld bytes (%d%%) zeros=%ld\n", bytes_scanned, vddk_bytes, percent, bytes_zero);
+            LOGDEBUG("transfer progress %ld/%ld bytes (%d%%) zeros=%ld (%d%% not written)\n", bytes_scanned, vddk_bytes, percent, bytes_zero,
+                     (int)((bytes_zero * 100) / bytes_scanned));
         }
     }
 
+    // skipping zeroes at the end does not extend the file the way writing them would
+    if ((fp != STDOUT) && (fstat(fp, &mystat) == 0) && (mystat.st_size < ((end_sector + 1) * VIXDISKLIB_SECTOR_SIZE))
+        && (ftruncate(fp, ((end_sector + 1) * VIXDISKLIB_SECTOR_SIZE)) != 0)) {
+        LOGERROR("failed to extend '%s' to %lld sectors, giving up", disk_path, (end_sector + 1));
+        goto out;
+    }
+
     after = time(NULL);
     ret = EUCA_OK;
 
-    LOGINFO("download of %ldMB-disk took %d seconds (zero sectors=%ld/%ld)\n", vddk_bytes / 1000000, (int)(after - before), zero_sectors, vddk_blocks);
+    LOGINFO("download of %ldMB-disk took %d seconds (zero sectors=%ld/%ld, not written)\n", vddk_bytes / 1000000, (int)(after - before), zero_sectors, vddk_blocks);
 
 out:
+    EUCA_FREE(buf);
     close(fp);
     cleanup(&s);
     return ret;
@@ -974,6 +1118,9 @@ int vmdk_convert_local(const char *disk_path, const char *vmdk_path, boolean ove
     s64 vddk_blocks = 0;
     s64 vddk_bytes = 0;
     s64 zero_sectors = 0;
+    s64 hole_sectors = 0;
+    s64 offset = 0;
+    s64 data = 0;
     time_t after = 0;
     time_t before = 0;
     boolean all_zeros = TRUE;
@@ -1063,6 +1210,22 @@ int vmdk_convert_local(const char *disk_path, const char *vmdk_path, boolean ove
 
     before = time(NULL);
     for (seen_partial = FALSE, zero_sectors = 0, sector = 0; sector < vddk_blocks; sector++) {
+        // skip the hole of a sparse input file, if the last sector read may have been in one
+        if (all_zeros && S_ISREG(mystat.st_mode)) {
+            offset = ((s64) sector) * VIXDISKLIB_SECTOR_SIZE;
+            if ((data = skip_hole(fp, offset, true_bytes)) < 0) {
+                LOGERROR("failed to seek in input file: %s\n", strerror(errno));
+                goto out;
+            }
+            if (data > offset) {
+                hole_sectors += ((data - offset) / VIXDISKLIB_SECTOR_SIZE);
+                zero_sectors += ((data - offset) / VIXDISKLIB_SECTOR_SIZE);
+                sector += ((data - offset) / VIXDISKLIB_SECTOR_SIZE);
+                if (sector >= vddk_blocks)
+                    break;
+            }
+        }
+
         if ((bytes_read = read(fp, buf, VIXDISKLIB_SECTOR_SIZE)) != VIXDISKLIB_SECTOR_SIZE) {
             if (bytes_read > 0) {      // partially written sector
                 if (seen_partial) {
@@ -1080,15 +1243,7 @@ int vmdk_convert_local(const char *disk_path, const char *vmdk_path, boolean ove
                 LOGERROR("failed to read input file\n");
             }
         }
-        // scan for all zeros
-        for (all_zeros = TRUE, i = 0; i < VIXDISKLIB_SECTOR_SIZE; i++) {
-            if (buf[i] != 0) {
-                all_zeros = FALSE;
-                break;
-            }
-        }
-
-        if (!all_zeros) {
+        if (!(all_zeros = is_zero(buf, VIXDISKLIB_SECTOR_SIZE))) {
             vixError = VixDiskLib_Write(s.diskHandleLocal, sector, 1, buf);
             CHECK_ERROR();
         } else {
@@ -1097,7 +1252,8 @@ int vmdk_convert_local(const char *disk_path, const char *vmdk_path, boolean ove
     }
 
     after = time(NULL);
-    LOGINFO("copy of %ldMB-disk took %d seconds (zero sectors=%ld/%ld)\n", vddk_bytes / 1000000, (int)(after - before), zero_sectors, vddk_blocks);
+    LOGINFO("copy of %ldMB-disk took %d seconds (zero sectors=%ld/%ld, of which %ld in holes, not copied)\n", vddk_bytes / 1000000, (int)(after - before),
+            zero_sectors, vddk_blocks, hole_sectors);
 
     ret = EUCA_OK;
 
@@ -207,6 +207,8 @@ static int set_paths(void)
 //!
 static struct vmdk_shmem *alloc_shmem(void)
 {
+    int tries = 0;
+    int proj_id = 0;
     int shmid = -1;
     key_t key = -1;
     void *mem = ((void *)-1);
@@ -214,16 +216,21 @@ static struct vmdk_shmem *alloc_shmem(void)
 
     set_paths();
 
-    // generate a shared-memory region key
-    if ((key = ftok(my_path, (int)getpid())) == -1) {
-        LOGERROR("failed to generate a System V IPC key: %s\n", strerror(errno));
-        return NULL;
-    }
+    // generate a shared-memory region key, ftok() only uses the low 8 bits of the
+    // project ID so concurrent callers, e.g., parallel conversion workers, may collide
+    for (proj_id = (int)getpid(); shmid == -1; proj_id++) {
+        if ((key = ftok(my_path, proj_id)) == -1) {
+            LOGERROR("failed to generate a System V IPC key: %s\n", strerror(errno));
+            return NULL;
+        }
 
-    LOGDEBUG("generated shared memory segment key [%u]\n", key);
-    if ((shmid = shmget(key, sizeof(struct vmdk_shmem), IPC_CREAT | IPC_EXCL | 0600)) == -1) {
-        LOGERROR("failed to allocate shared memory segment: %s\n", strerror(errno));
-        return NULL;
+        LOGDEBUG("generated shared memory segment key [%u]\n", key);
+        if ((shmid = shmget(key, sizeof(struct vmdk_shmem), IPC_CREAT | IPC_EXCL | 0600)) == -1) {
+            if ((errno != EEXIST) || (++tries >= 256)) {
+                LOGERROR("failed to allocate shared memory segment: %s\n", strerror(errno));
+                return NULL;
+            }
+        }
     }
 
     if ((mem = shmat(shmid, NULL, 0)) == ((void *)-1)) {
@@ -78,6 +78,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>                    /* close */
+#include <errno.h>
 #include <assert.h>
 #include <string.h>
 #include <strings.h>
@@ -86,12 +87,15 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <limits.h> /* LOGIN_NAME_MAX */
+#include <ctype.h>
+#include <pthread.h>
 
 #include "eucalyptus.h"
 #include "config.h"
 #include "misc.h"
 #include "ipc.h"
 #include "euca_string.h"
+#include "euca_file.h"
 #include "iscsi.h"
 
 /*----------------------------------------------------------------------------*\
@@ -105,6 +109,27 @@
 #define CONNECT_TIMEOUT                           600
 #define DISCONNECT_TIMEOUT                        600
 #define GET_TIMEOUT                                60
+#define SECRET_TIMEOUT                             60
+
+#define TARGET_LOCKS                               32   //!< operations on targets that hash to different locks run in parallel
+#define MAX_DEV_FIELDS                            128   //!< most comma-separated fields in a connection string
+#define MAX_STORAGE_IFACES                         16   //!< most storage interfaces whose iSCSI iface is remembered
+#define MAX_TARGET_SESSIONS                        64   //!< most iSCSI targets whose sessions are tracked
+#define MAX_TARGET_LUNS                            64   //!< most LUNs tracked per iSCSI target
+
+//! Fields of the connection string that the SC hands out for a volume
+#define DEV_FIELD_PROTOCOL                          0
+#define DEV_FIELD_LUN                               4
+#define DEV_FIELD_PASSWORD                          5
+#define DEV_FIELD_PATHS                             6   //!< start of the <iface>,<ip>,<store> triples of an iSCSI target
+
+#define PROTOCOL_RBD                            "rbd"
+#define SECRET_TYPE_CEPH                       "ceph"
+
+//! Hints handed to the scripts about the sessions of a target
+#define SESSION_HINT_NONE                      "none"   //!< the NC knows of no session to the target
+#define SESSION_HINT_REUSE                    "reuse"   //!< other volumes are connected over the sessions of the target
+#define SESSION_HINT_KEEP               "keepsession"   //!< other volumes still use the sessions of the target
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -124,6 +149,13 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! The LUNs this NC has connected behind one iSCSI target, over the same set of paths
+typedef struct target_session_t {
+    char paths[EUCA_MAX_PATH];         //!< the <iface>,<ip>,<store> triples of the target, trailing dots of the stores removed
+    int luns[MAX_TARGET_LUNS];         //!< the connected LUNs
+    int nluns;                         //!< number of entries in luns[], the target has no entry once this drops to 0
+} target_session;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -156,7 +188,15 @@ static char ceph_keyring[EUCA_MAX_PATH] = DEFAULT_CEPH_KEYRING;
 // path to ceph conf file on the local host
 static char ceph_conf[EUCA_MAX_PATH] = DEFAULT_CEPH_CONF;
 
-static sem *iscsi_sem = NULL;          //!< for serializing attach and detach invocations
+static sem *iscsi_sem = NULL;          //!< protects known_ifaces[] and target_sessions[]
+static sem *target_sems[TARGET_LOCKS] = { NULL };  //!< for serializing attach and detach invocations on the same target
+static pthread_rwlock_t iface_lock = PTHREAD_RWLOCK_INITIALIZER;    //!< held exclusively while the script may have to create an iSCSI iface
+
+static char known_ifaces[MAX_STORAGE_IFACES][64] = { "" }; //!< storage interfaces whose iSCSI iface is known to exist
+static target_session target_sessions[MAX_TARGET_SESSIONS];    //!< targets this NC keeps logged in for connected volumes
+static pthread_mutex_t ceph_secret_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< for serializing the setup of the libvirt secret
+static char ceph_secret_uuid[64] = ""; //!< libvirt secret last found to hold the key of the Ceph user
+static char ceph_secret_key[256] = "";
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -164,6 +204,21 @@ static sem *iscsi_sem = NULL;          //!< for serializing attach and detach in
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int split_dev_string(const char *dev_string, char *buf, size_t buf_size, char **fields);
+static boolean is_safe_token(const char *str, const char *extra);
+static int lock_target(const char *dev_string, boolean may_create_iface, boolean * exclusive);
+static void unlock_target(int idx, boolean exclusive);
+static void remember_ifaces(const char *dev_string);
+static int target_session_key(const char *dev_string, char *key, size_t key_size);
+static target_session *find_target_session(const char *key);
+static boolean has_target_session(const char *dev_string);
+static void ref_target_session(const char *dev_string);
+static int unref_target_session(const char *dev_string);
+static int read_ceph_key(char *key, size_t key_size);
+static int read_ceph_monitors(char *hosts, size_t hosts_size);
+static int setup_ceph_secret(const char *uuid, const char *key);
+static char *connect_rbd_target(const char *target_dev, const char *target_serial, const char *target_bus, char **fields, int nfields);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -211,10 +266,512 @@ void init_iscsi(const char *euca_home, const char *new_ceph_user, const char *ne
         LOGDEBUG("Ceph configuration path: %s\n", ceph_conf);
     }
 
-    // initialize the semaphore on first invocation only
+    // initialize the semaphores on first invocation only
     if (iscsi_sem == NULL) {
         iscsi_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+        for (int i = 0; i < TARGET_LOCKS; i++) {
+            target_sems[i] = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+        }
+    }
+}
+
+//!
+//! Splits a connection string at its commas, keeping empty fields
+//!
+//! @param[in]  dev_string the connection string
+//! @param[out] buf        buffer that the fields will point into
+//! @param[in]  buf_size   size of buf
+//! @param[out] fields     array of MAX_DEV_FIELDS entries receiving the fields
+//!
+//! @return the number of fields
+//!
+static int split_dev_string(const char *dev_string, char *buf, size_t buf_size, char **fields)
+{
+    int n = 0;
+    char *ptr = buf;
+
+    euca_strncpy(buf, dev_string, buf_size);
+    while ((ptr != NULL) && (n < MAX_DEV_FIELDS)) {
+        fields[n++] = strsep(&ptr, ",");
+    }
+    return (n);
+}
+
+//!
+//! Tells whether a value taken from a connection string or a Ceph file can be put
+//! on a command line and into libvirt XML as is
+//!
+//! @param[in] str   the value
+//! @param[in] extra characters allowed besides letters and digits
+//!
+//! @return TRUE if the value is not empty and only has allowed characters
+//!
+static boolean is_safe_token(const char *str, const char *extra)
+{
+    if ((str == NULL) || (*str == '\0'))
+        return (FALSE);
+
+    for (; *str; str++) {
+        if (!isalnum((unsigned char)*str) && (strchr(extra, *str) == NULL))
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+//!
+//! Locks the target that a connection string refers to. Operations on the same iSCSI target
+//! (e.g. two LUNs behind one IQN, which share a session) or the same RBD image are serialized,
+//! the others do not wait on each other. Since the connect script may create an iface for a
+//! storage interface that it has not seen yet, picking the first unused name, such a connect
+//! runs alone.
+//!
+//! @param[in]  dev_string       the connection string
+//! @param[in]  may_create_iface set if the operation is a connect
+//! @param[out] exclusive        set if the operation has to run alone
+//!
+//! @return the index of the lock that was taken, to pass to unlock_target()
+//!
+static int lock_target(const char *dev_string, boolean may_create_iface, boolean * exclusive)
+{
+    int i = 0;
+    int j = 0;
+    int nfields = 0;
+    int len = 0;
+    unsigned int hash = 5381;
+    char buf[EUCA_MAX_PATH * 4] = "";
+    char *fields[MAX_DEV_FIELDS] = { NULL };
+    const char *key = NULL;
+
+    *exclusive = FALSE;
+    nfields = split_dev_string(dev_string, buf, sizeof(buf), fields);
+    if ((nfields > DEV_FIELD_LUN) && !strcmp(fields[DEV_FIELD_PROTOCOL], PROTOCOL_RBD)) {
+        for (key = fields[DEV_FIELD_LUN]; *key; key++)
+            hash = ((hash << 5) + hash) + (unsigned char)*key;
+    } else {
+        for (i = DEV_FIELD_PATHS; (i + 2) < nfields; i += 3) {
+            // the script ignores a trailing dot of the store
+            len = strlen(fields[i + 2]);
+            if ((len > 0) && (fields[i + 2][len - 1] == '.'))
+                len--;
+            for (j = 0; j < len; j++)
+                hash = ((hash << 5) + hash) + (unsigned char)fields[i + 2][j];
+
+            if (may_create_iface && (fields[i][0] != '\0')) {
+                sem_p(iscsi_sem);
+                for (j = 0; (j < MAX_STORAGE_IFACES) && strcmp(known_ifaces[j], fields[i]); j++) ;
+                sem_v(iscsi_sem);
+                if (j == MAX_STORAGE_IFACES)
+                    *exclusive = TRUE;
+            }
+        }
+    }
+
+    if (*exclusive) {
+        pthread_rwlock_wrlock(&iface_lock);
+    } else {
+        pthread_rwlock_rdlock(&iface_lock);
+    }
+
+    i = (hash % TARGET_LOCKS);
+    sem_p(target_sems[i]);
+    return (i);
+}
+
+//!
+//! Unlocks a target locked with lock_target()
+//!
+//! @param[in] idx       the index returned by lock_target()
+//! @param[in] exclusive as set by lock_target()
+//!
+static void unlock_target(int idx, boolean exclusive)
+{
+    sem_v(target_sems[idx]);
+    pthread_rwlock_unlock(&iface_lock);
+}
+
+//!
+//! Remembers the storage interfaces of a target that was connected, since the script has
+//! then made sure they all have an iSCSI iface
+//!
+//! @param[in] dev_string the connection string
+//!
+static void remember_ifaces(const char *dev_string)
+{
+    int i = 0;
+    int j = 0;
+    int nfields = 0;
+    char buf[EUCA_MAX_PATH * 4] = "";
+    char *fields[MAX_DEV_FIELDS] = { NULL };
+
+    nfields = split_dev_string(dev_string, buf, sizeof(buf), fields);
+    sem_p(iscsi_sem);
+    for (i = DEV_FIELD_PATHS; (i + 2) < nfields; i += 3) {
+        if (fields[i][0] == '\0')
+            continue;
+        for (j = 0; (j < MAX_STORAGE_IFACES) && known_ifaces[j][0] && strcmp(known_ifaces[j], fields[i]); j++) ;
+        if ((j < MAX_STORAGE_IFACES) && (known_ifaces[j][0] == '\0'))
+            euca_strncpy(known_ifaces[j], fields[i], sizeof(known_ifaces[j]));
+    }
+    sem_v(iscsi_sem);
+}
+
+//!
+//! Builds the key under which the sessions of an iSCSI target are tracked, out of its paths
+//!
+//! @param[in]  dev_string the connection string
+//! @param[out] key        the paths of the target
+//! @param[in]  key_size   size of key
+//!
+//! @return the LUN of the volume, or -1 if the volume does not share sessions with others
+//!         (an RBD volume or a target exporting a single volume)
+//!
+static int target_session_key(const char *dev_string, char *key, size_t key_size)
+{
+    int i = 0;
+    int len = 0;
+    int lun = -1;
+    int nfields = 0;
+    size_t off = 0;
+    char *end = NULL;
+    char buf[EUCA_MAX_PATH * 4] = "";
+    char *fields[MAX_DEV_FIELDS] = { NULL };
+
+    key[0] = '\0';
+    nfields = split_dev_string(dev_string, buf, sizeof(buf), fields);
+    if ((nfields <= DEV_FIELD_PATHS) || !strcmp(fields[DEV_FIELD_PROTOCOL], PROTOCOL_RBD) || (fields[DEV_FIELD_LUN][0] == '\0'))
+        return (-1);
+
+    errno = 0;
+    lun = strtol(fields[DEV_FIELD_LUN], &end, 10);
+    if ((errno != 0) || (*end != '\0') || (lun < 0))
+        return (-1);
+
+    for (i = DEV_FIELD_PATHS; (i + 2) < nfields; i += 3) {
+        // the scripts ignore a trailing dot of the store
+        len = strlen(fields[i + 2]);
+        if ((len > 0) && (fields[i + 2][len - 1] == '.'))
+            fields[i + 2][len - 1] = '\0';
+        off += snprintf(key + off, key_size - off, "%s%s,%s,%s", ((off == 0) ? "" : ","), fields[i], fields[i + 1], fields[i + 2]);
+        if (off >= key_size)
+            return (-1);
+    }
+    return (lun);
+}
+
+//!
+//! Finds the tracked sessions of a target. The caller must hold iscsi_sem.
+//!
+//! @param[in] key the key built by target_session_key()
+//!
+//! @return the entry of the target or NULL if this NC has no volume connected behind it
+//!
+static target_session *find_target_session(const char *key)
+{
+    for (int i = 0; i < MAX_TARGET_SESSIONS; i++) {
+        if ((target_sessions[i].nluns > 0) && !strcmp(target_sessions[i].paths, key))
+            return (&target_sessions[i]);
+    }
+    return (NULL);
+}
+
+//!
+//! Tells whether the NC already has volumes connected over the sessions of a target, in which
+//! case the connect script can skip the login and only scan for the new LUN
+//!
+//! @param[in] dev_string the connection string
+//!
+//! @return TRUE if another LUN of the target is connected
+//!
+static boolean has_target_session(const char *dev_string)
+{
+    int lun = 0;
+    boolean found = FALSE;
+    char key[EUCA_MAX_PATH] = "";
+    target_session *ts = NULL;
+
+    if ((lun = target_session_key(dev_string, key, sizeof(key))) < 0)
+        return (FALSE);
+
+    sem_p(iscsi_sem);
+    if ((ts = find_target_session(key)) != NULL) {
+        for (int i = 0; i < ts->nluns; i++) {
+            if (ts->luns[i] != lun)
+                found = TRUE;
+        }
+    }
+    sem_v(iscsi_sem);
+    return (found);
+}
+
+//!
+//! Records that the LUN of a connection string was connected. Connecting the same LUN
+//! again does not count twice.
+//!
+//! @param[in] dev_string the connection string
+//!
+static void ref_target_session(const char *dev_string)
+{
+    int i = 0;
+    int lun = 0;
+    char key[EUCA_MAX_PATH] = "";
+    target_session *ts = NULL;
+
+    if ((lun = target_session_key(dev_string, key, sizeof(key))) < 0)
+        return;
+
+    sem_p(iscsi_sem);
+    if ((ts = find_target_session(key)) == NULL) {
+        for (i = 0; (i < MAX_TARGET_SESSIONS) && (target_sessions[i].nluns > 0); i++) ;
+        if (i < MAX_TARGET_SESSIONS) {
+            ts = &target_sessions[i];
+            euca_strncpy(ts->paths, key, sizeof(ts->paths));
+        }
+    }
+
+    if (ts != NULL) {
+        for (i = 0; (i < ts->nluns) && (ts->luns[i] != lun); i++) ;
+        if ((i == ts->nluns) && (ts->nluns < MAX_TARGET_LUNS))
+            ts->luns[ts->nluns++] = lun;
+    }
+    sem_v(iscsi_sem);
+}
+
+//!
+//! Records that the LUN of a connection string is being disconnected
+//!
+//! @param[in] dev_string the connection string
+//!
+//! @return the number of other LUNs of the target that stay connected
+//!
+static int unref_target_session(const char *dev_string)
+{
+    int i = 0;
+    int lun = 0;
+    int left = 0;
+    char key[EUCA_MAX_PATH] = "";
+    target_session *ts = NULL;
+
+    if ((lun = target_session_key(dev_string, key, sizeof(key))) < 0)
+        return (0);
+
+    sem_p(iscsi_sem);
+    if ((ts = find_target_session(key)) != NULL) {
+        for (i = 0; (i < ts->nluns) && (ts->luns[i] != lun); i++) ;
+        if (i < ts->nluns)
+            ts->luns[i] = ts->luns[--ts->nluns];
+        left = ts->nluns;
+    }
+    sem_v(iscsi_sem);
+    return (left);
+}
+
+//!
+//! Reads the key of the configured Ceph user from the Ceph keyring
+//!
+//! @param[out] key      the base64 key
+//! @param[in]  key_size size of key
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the key cannot be found
+//!
+static int read_ceph_key(char *key, size_t key_size)
+{
+    FILE *fp = NULL;
+    char line[1024] = "";
+    char section[LOGIN_NAME_MAX + 16] = "";
+    char value[256] = "";
+    boolean in_user = FALSE;
+
+    if ((fp = fopen(ceph_keyring, "r")) == NULL) {
+        LOGERROR("unable to open ceph keyring file %s\n", ceph_keyring);
+        return (EUCA_ERROR);
+    }
+
+    snprintf(section, sizeof(section), "[client.%s]", ceph_user);
+    key[0] = '\0';
+    while ((key[0] == '\0') && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '[') {
+            in_user = (strcmp(line, section) == 0);
+        } else if (in_user && (sscanf(line, " key = %255s", value) == 1)) {
+            euca_strncpy(key, value, key_size);
+        }
+    }
+    fclose(fp);
+
+    if (!is_safe_token(key, "+/=")) {
+        LOGERROR("no usable key for ceph user %s in %s\n", ceph_user, ceph_keyring);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Reads the Ceph monitors from the 'mon addr = a.b.c.d:port,...' lines of the Ceph
+//! configuration and turns them into libvirt <host> elements
+//!
+//! @param[out] hosts      the <host> elements
+//! @param[in]  hosts_size size of hosts
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if no monitor can be found
+//!
+static int read_ceph_monitors(char *hosts, size_t hosts_size)
+{
+    int ret = EUCA_OK;
+    FILE *fp = NULL;
+    char line[1024] = "";
+    char host[128] = "";
+    char *addrs = NULL;
+    char *addr = NULL;
+    char *port = NULL;
+    char *saveptr = NULL;
+
+    if ((fp = fopen(ceph_conf, "r")) == NULL) {
+        LOGERROR("unable to open %s\n", ceph_conf);
+        return (EUCA_ERROR);
+    }
+
+    hosts[0] = '\0';
+    while ((ret == EUCA_OK) && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        for (addrs = line; isspace((unsigned char)*addrs); addrs++) ;
+        if (strncmp(addrs, "mon addr", 8))
+            continue;
+        for (addrs += 8; isspace((unsigned char)*addrs); addrs++) ;
+        if (*addrs++ != '=')
+            continue;
+
+        for (addr = strtok_r(addrs, ", \t", &saveptr); addr; addr = strtok_r(NULL, ", \t", &saveptr)) {
+            if ((port = strchr(addr, ':')) != NULL)
+                *port++ = '\0';
+            if ((port == NULL) || !is_safe_token(addr, ".-") || !is_safe_token(port, "")) {
+                LOGERROR("either monitor address or port information not found, looking for 'mon addr = a.b.c.d:xyz' like configuration in %s\n", ceph_conf);
+                ret = EUCA_ERROR;
+                break;
+            }
+            snprintf(host, sizeof(host), "    <host name='%s' port='%s'/>\n", addr, port);
+            euca_strncat(hosts, host, hosts_size);
+        }
+    }
+    fclose(fp);
+
+    if ((ret == EUCA_OK) && (hosts[0] == '\0')) {
+        LOGERROR("monitor address and port information not found, looking for 'mon addr = a.b.c.d:xyz' like configuration in %s\n", ceph_conf);
+        ret = EUCA_ERROR;
+    }
+    return (ret);
+}
+
+//!
+//! Makes sure that libvirt has a secret with the given UUID holding the key of the Ceph user.
+//! Once that was verified, later volumes that use the same secret do not run virsh at all.
+//!
+//! @param[in] uuid the UUID of the secret, as given by the SC
+//! @param[in] key  the key of the Ceph user
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int setup_ceph_secret(const char *uuid, const char *key)
+{
+    int ret = EUCA_OK;
+    char virsh[EUCA_MAX_PATH] = "";
+    char command[EUCA_MAX_PATH * 2] = "";
+    char secret[1024] = "";
+    char secret_path[EUCA_MAX_PATH] = "";
+    char stdout_str[MAX_OUTPUT] = "";
+    char stderr_str[MAX_OUTPUT] = "";
+
+    pthread_mutex_lock(&ceph_secret_mutex);
+    if (!strcmp(ceph_secret_uuid, uuid) && !strcmp(ceph_secret_key, key)) {
+        pthread_mutex_unlock(&ceph_secret_mutex);
+        return (EUCA_OK);
+    }
+
+    snprintf(virsh, sizeof(virsh), EUCALYPTUS_VIRSH, home);
+    snprintf(command, sizeof(command), "%s secret-get-value %s", virsh, uuid);
+    if ((timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, SECRET_TIMEOUT) == 0) && !strncmp(stdout_str, key, strlen(key))
+        && ((stdout_str[strlen(key)] == '\0') || (stdout_str[strlen(key)] == '\n'))) {
+        LOGDEBUG("virsh secret %s already configured\n", uuid);
+    } else {
+        LOGINFO("setting up virsh secret %s for ceph user %s\n", uuid, ceph_user);
+        snprintf(command, sizeof(command), "%s secret-undefine %s", virsh, uuid);
+        timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, SECRET_TIMEOUT);
+
+        snprintf(secret, sizeof(secret), "<secret ephemeral='no' private='no'>\n  <uuid>%s</uuid>\n  <usage type='%s'>\n    <name>%s</name>\n  </usage>\n</secret>\n", uuid,
+                 SECRET_TYPE_CEPH, uuid);
+        snprintf(secret_path, sizeof(secret_path), EUCALYPTUS_STATE_DIR "/virsh_ceph_secret.xml-XXXXXX", home);
+        if (str2file(secret, secret_path, 0, 0600, TRUE) != EUCA_OK) {
+            ret = EUCA_ERROR;
+        } else {
+            snprintf(command, sizeof(command), "%s secret-define --file %s", virsh, secret_path);
+            if (timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, SECRET_TIMEOUT) != 0) {
+                LOGERROR("failed to define virsh secret %s: %s\n", uuid, stderr_str);
+                ret = EUCA_ERROR;
+            } else {
+                snprintf(command, sizeof(command), "%s secret-set-value %s --base64 %s", virsh, uuid, key);
+                if (timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, SECRET_TIMEOUT) != 0) {
+                    LOGERROR("failed to set value of virsh secret %s: %s\n", uuid, stderr_str);
+                    ret = EUCA_ERROR;
+                }
+            }
+            unlink(secret_path);
+        }
+    }
+
+    if (ret == EUCA_OK) {
+        euca_strncpy(ceph_secret_uuid, uuid, sizeof(ceph_secret_uuid));
+        euca_strncpy(ceph_secret_key, key, sizeof(ceph_secret_key));
     }
+    pthread_mutex_unlock(&ceph_secret_mutex);
+    return (ret);
+}
+
+//!
+//! Generates the libvirt XML of an RBD volume. The hypervisor talks to Ceph itself, so
+//! there is nothing to log into and no device to wait for on the node.
+//!
+//! @param[in] target_dev    the device name of the volume in the guest
+//! @param[in] target_serial the serial number of the volume
+//! @param[in] target_bus    the bus the volume is attached to
+//! @param[in] fields        the fields of the connection string
+//! @param[in] nfields       the number of fields
+//!
+//! @return the libvirt XML, which the caller must free, or NULL on failure
+//!
+static char *connect_rbd_target(const char *target_dev, const char *target_serial, const char *target_bus, char **fields, int nfields)
+{
+    char key[256] = "";
+    char hosts[4096] = "";
+    char xml[8192] = "";
+    const char *image = NULL;
+    const char *uuid = NULL;
+
+    if (nfields <= DEV_FIELD_PASSWORD) {
+        LOGERROR("incomplete rbd connection string\n");
+        return (NULL);
+    }
+
+    image = fields[DEV_FIELD_LUN];
+    uuid = fields[DEV_FIELD_PASSWORD];
+    if (!is_safe_token(image, "._-/@") || !is_safe_token(uuid, "-")) {
+        LOGERROR("invalid rbd image name or secret in connection string\n");
+        return (NULL);
+    }
+
+    if ((read_ceph_key(key, sizeof(key)) != EUCA_OK) || (setup_ceph_secret(uuid, key) != EUCA_OK) || (read_ceph_monitors(hosts, sizeof(hosts)) != EUCA_OK)) {
+        return (NULL);
+    }
+
+    snprintf(xml, sizeof(xml),
+             "<disk type='network' device='disk'>\n"
+             "  <source protocol='rbd' name='%s'>\n"
+             "%s"
+             "  </source>\n"
+             "  <auth username='%s'>\n"
+             "    <secret type='%s' uuid='%s'/>\n"
+             "  </auth>\n"
+             "  <target bus='%s' dev='%s'/>\n"
+             "  <serial>%s</serial>\n" "</disk>\n", image, hosts, ceph_user, SECRET_TYPE_CEPH, uuid, target_bus, target_dev, target_serial);
+    return (strdup(xml));
 }
 
 //!
@@ -227,13 +784,32 @@ void init_iscsi(const char *euca_home, const char *new_ceph_user, const char *ne
 char *connect_iscsi_target(const char *volume_id, const char *target_dev, const char *target_serial, const char *target_bus, const char *dev_string)
 {
     int ret = 0;
+    int idx = 0;
+    int nfields = 0;
+    boolean exclusive = FALSE;
+    boolean reuse = FALSE;
+    char *xml = NULL;
+    char buf[EUCA_MAX_PATH * 4] = "";
+    char *fields[MAX_DEV_FIELDS] = { NULL };
     char command[EUCA_MAX_PATH] = "";
     char stdout_str[MAX_OUTPUT] = "";
     char stderr_str[MAX_OUTPUT] = "";
 
     assert(strlen(home));
 
-    snprintf(command, EUCA_MAX_PATH, "%s %s,%s,%s,%s,%s,%s,%s,%s,%s", 
+    // RBD volumes only need their libvirt XML, which is put together here rather than by the script
+    nfields = split_dev_string(dev_string, buf, sizeof(buf), fields);
+    if (!strcmp(fields[DEV_FIELD_PROTOCOL], PROTOCOL_RBD)) {
+        LOGDEBUG("[%s] connecting rbd volume\n", volume_id);
+        idx = lock_target(dev_string, FALSE, &exclusive);
+        xml = connect_rbd_target(target_dev, target_serial, target_bus, fields, nfields);
+        unlock_target(idx, exclusive);
+        return (xml);
+    }
+
+    idx = lock_target(dev_string, TRUE, &exclusive);
+    reuse = has_target_session(dev_string);
+    snprintf(command, EUCA_MAX_PATH, "%s %s,%s,%s,%s,%s,%s,%s,%s,%s %s", 
              connect_storage_cmd_path, 
              home,
              volume_id,
@@ -243,12 +819,17 @@ char *connect_iscsi_target(const char *volume_id, const char *target_dev, const
              ceph_user,
              ceph_keyring,
              ceph_conf,
-             dev_string);
-    LOGDEBUG("invoking `%s`\n", command);
+             dev_string,
+             ((reuse) ? (SESSION_HINT_REUSE) : (SESSION_HINT_NONE)));
+    LOGDEBUG("[%s] invoking `%s`\n", volume_id, command);
 
-    sem_p(iscsi_sem);
     ret = timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, CONNECT_TIMEOUT);
-    sem_v(iscsi_sem);
+    if (ret == 0) {
+        if (exclusive)
+            remember_ifaces(dev_string);
+        ref_target_session(dev_string);
+    }
+    unlock_target(idx, exclusive);
     LOGDEBUG("connect script returned: %d, stdout: '%s', stderr: '%s'\n", ret, stdout_str, stderr_str);
 
     if (ret == 0)
@@ -267,22 +848,34 @@ char *connect_iscsi_target(const char *volume_id, const char *target_dev, const
 int disconnect_iscsi_target(const char *dev_string, boolean do_rescan)
 {
     int ret = 0;
+    int idx = 0;
+    int left = 0;
+    boolean exclusive = FALSE;
     char command[EUCA_MAX_PATH] = "";
     char stdout_str[MAX_OUTPUT] = "";
     char stderr_str[MAX_OUTPUT] = "";
 
     assert(strlen(home));
 
-    snprintf(command, EUCA_MAX_PATH, "%s %s,,,,,,,,%s%s", 
+    // nothing was set up on the node for an RBD volume
+    if (!strncmp(dev_string, PROTOCOL_RBD ",", strlen(PROTOCOL_RBD ","))) {
+        LOGDEBUG("found rbd as protocol in connection string, disconnecting is a no-op\n");
+        return (0);
+    }
+
+    // the sessions stay up while other volumes of the NC are behind the same target
+    idx = lock_target(dev_string, FALSE, &exclusive);
+    left = unref_target_session(dev_string);
+    snprintf(command, EUCA_MAX_PATH, "%s %s,,,,,,,,%s %s %s", 
              disconnect_storage_cmd_path, 
              home,
              dev_string,
-             (do_rescan)?(" norescan"):(""));
+             (do_rescan)?("norescan"):("default"),
+             ((left > 0) ? (SESSION_HINT_KEEP) : (SESSION_HINT_NONE)));
     LOGDEBUG("invoking `%s`\n", command);
 
-    sem_p(iscsi_sem);
     ret = timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, DISCONNECT_TIMEOUT);
-    sem_v(iscsi_sem);
+    unlock_target(idx, exclusive);
     LOGDEBUG("disconnect script returned: %d, stdout: '%s', stderr: '%s'\n", ret, stdout_str, stderr_str);
 
     return (ret);
@@ -298,20 +891,28 @@ int disconnect_iscsi_target(const char *dev_string, boolean do_rescan)
 char *get_iscsi_target(const char *dev_string)
 {
     int ret = 0;
+    int idx = 0;
+    boolean exclusive = FALSE;
     char command[EUCA_MAX_PATH] = "";
     char stdout_str[MAX_OUTPUT] = "";
     char stderr_str[MAX_OUTPUT] = "";
 
     assert(strlen(home));
+
+    // an RBD volume has no local device
+    if (!strncmp(dev_string, PROTOCOL_RBD ",", strlen(PROTOCOL_RBD ","))) {
+        return (strdup("no-op"));
+    }
+
     snprintf(command, EUCA_MAX_PATH, "%s %s,,,,,,,,%s", 
              get_storage_cmd_path, 
              home,
              dev_string);
     LOGDEBUG("invoking `%s`\n", command);
 
-    sem_p(iscsi_sem);
+    idx = lock_target(dev_string, FALSE, &exclusive);
     ret = timeshell(command, stdout_str, stderr_str, MAX_OUTPUT, GET_TIMEOUT);
-    sem_v(iscsi_sem);
+    unlock_target(idx, exclusive);
     LOGDEBUG("get storage script returned: %d, stdout: '%s', stderr: '%s'\n", ret, stdout_str, stderr_str);
 
     if (ret == 0)
@@ -65,8 +65,8 @@
 
 //!
 //! @file storage/map.c
-//! Implementation of a dumb and dangerous map library (uses a linked list, allocates
-//! and frees memory for keys, but leaves memory management of values to the user)
+//! Implementation of a simple map library (allocates and frees memory for keys, but leaves
+//! memory management of values to the user), over the hash table of util/hashtable.c
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -130,8 +130,6 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-inline static void set(map * m, const char *key, void *val);
-
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -151,84 +149,50 @@ inline static void set(map * m, const char *key, void *val);
 \*----------------------------------------------------------------------------*/
 
 //!
-//! Allocate a new MAP entry
+//! Allocate a new MAP
 //!
-//! @param[in] size unused parameter
+//! @param[in] size how many keys to make room for; the map grows beyond as needed
 //!
-//! @return a pointer to the new map entry structure or NULL if any error occured
+//! @return a pointer to the new map or NULL if any error occured
 //!
 map *map_create(int size)
 {
-    return ((map *) EUCA_ZALLOC(1, sizeof(map)));
-}
-
- //!
- //! Initialize a given map entry with a key and value
- //!
- //! @param[in] m a pointer to the map entry structure
- //! @param[in] key the unique key string
- //! @param[in] val a transparent pointer to the value
- //!
-inline static void set(map * m, const char *key, void *val)
-{
-    m->key = strdup(key);
-    m->val = val;
-    m->next = NULL;
+    return (hashtable_create((size > 0) ? size : 0));
 }
 
 //!
-//! Initialize a given map entry with a key and value
+//! Sets the value of a key, adding the key to the map if needed
 //!
-//! @param[in] m a pointer to the map entry structure
+//! @param[in] m a pointer to the map
 //! @param[in] key the unique key string
 //! @param[in] val a transparent pointer to the value
 //!
 void map_set(map * m, const char *key, void *val)
 {
-    map *mp = NULL;
-
-    if (m->key == NULL) {
-        // empty map
-        set(m, key, val);
-    } else {
-        // map has stuff
-        for (mp = m; mp != NULL; mp = mp->next) {
-            if (strcmp(key, mp->key) == 0) {
-                // key already exists, overwrite it
-                mp->val = val;
-                return;
-            } else {
-                // we are at the end, so add a new entry
-                if (mp->next == NULL) {
-                    mp->next = map_create(1);
-                    mp = mp->next;
-                    if (mp != NULL)    //! @todo need to return an error if calloc failed
-                        set(mp, key, val);
-                    return;
-                }
-            }
-        }
-    }
+    hashtable_set(m, key, val);        //! @todo need to return an error if the key could not be added
 }
 
 //!
 //! Retrieves a map entry value matching the given key
 //!
-//! @param[in] m pointer to the head of the MAP
+//! @param[in] m pointer to the MAP
 //! @param[in] key the key we're looking for
 //!
 //! @return a transparent pointer to the matching value or NULL if any error occured
 //!
 void *map_get(map * m, char *key)
 {
-    map *mp = NULL;
+    return (hashtable_get(m, key));
+}
 
-    for (mp = m; mp != NULL; mp = mp->next) {
-        if ((mp->key != NULL) && (strcmp(key, mp->key) == 0)) {
-            return (mp->val);
-        }
-    }
-    return (NULL);
+//!
+//! Frees a map and its keys, but not the values
+//!
+//! @param[in] m pointer to the MAP, may be NULL
+//!
+void map_free(map * m)
+{
+    hashtable_free(m);
 }
 
 #ifdef _TEST_MAP
@@ -240,7 +204,7 @@ void *map_get(map * m, char *key)
 //!
 //! @return EUCA_OK on success or EUCA_ERROR on failure.
 //!
-//! @note little unit test: compile with gcc -g -D_TEST_MAP map.c
+//! @note little unit test: compile with gcc -g -D_TEST_MAP map.c ../util/hashtable.c ../util/euca_string.c
 //!
 int main(int argc, char *argv[])
 {
@@ -255,6 +219,7 @@ int main(int argc, char *argv[])
     assert(map_get(m, "k2") == s2);
     map_set(m, "k2", s1);
     assert(map_get(m, "k2") == s1);
+    map_free(m);
 
     return (EUCA_OK);
 }
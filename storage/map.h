@@ -68,8 +68,8 @@
 
 //!
 //! @file storage/map.h
-//! Definition of a dumb and dangerous map library (uses a linked list, allocates
-//! and frees memory for keys, but leaves memory management of values to the user)
+//! Definition of a simple map library (allocates and frees memory for keys, but leaves
+//! memory management of values to the user), over the hash table of util/hashtable.h
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -78,6 +78,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <hashtable.h>
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -103,11 +105,7 @@
 \*----------------------------------------------------------------------------*/
 
 //! MAP of key/value pairs
-typedef struct _map {
-    char *key;                         //!< unique key in the MAP
-    void *val;                         //!< value matching the key
-    struct _map *next;                 //!< pointer to the next map entry
-} map;
+typedef hashtable map;
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -124,6 +122,7 @@ typedef struct _map {
 map *map_create(int size);
 void map_set(map * m, const char *key, void *val);
 void *map_get(map * m, char *key);
+void map_free(map * m);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -87,6 +87,23 @@
 #include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/select.h>
+#include <ctype.h>
+#include <errno.h>
+#include <openssl/evp.h>
+#ifdef _BENCHMARK
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <openssl/bn.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#endif /* _BENCHMARK */
 #if defined(HAVE_ZLIB_H)
 #include <zlib.h>
 #endif /* HAVE_ZLIB_H */
@@ -98,6 +115,10 @@
 #include <euca_string.h>
 
 #include "objectstorage.h"
+#include "diskutil.h"                  // diskutil_io
+#ifdef _BENCHMARK
+#include "http.h"
+#endif /* _BENCHMARK */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -111,9 +132,15 @@
 #define FIRST_TIMEOUT                                 2 //!< in seconds, goes in powers of two afterwards
 #define MAX_TIMEOUT                                 300 //!< in seconds, the cap for growing timeout values
 #define CHUNK                                    262144 //!< buffer size for decompression operations
+#define INFLATE_RING_BYTES                (4 * CHUNK) //!< compressed bytes that may be in flight between the network and the inflater
 #define BUFSIZE                                  262144 //!< should be big enough for CERT and the signature
 #define STRSIZE                                    1024 //!< for short strings: files, hosts, URLs
 #define PROGRESS_UPDATE_SEC                           3 //!< how often to report on progress of long downloads
+#define BUNDLE_FETCHES                                4 //!< parts of a bundle downloaded at once when streaming an image
+#define BUNDLE_WINDOW                                 8 //!< how many parts the downloads may run ahead of unbundling
+#define BUNDLE_PART_BYTES                      10485760 //!< initial buffer for a part, which is the size bundling tools use
+#define TAR_BLOCK                                   512 //!< tar archives are made of headers and data in blocks of this size
+#define DROP_BEHIND_BYTES                  (64LL << 20) //!< with a DISKUTIL_IO_POLICY_DONTNEED output, how far behind the writes it is dropped from the page cache
 
 #define OBJECT_STORAGE_ENDPOINT                          "/services/objectstorage"
 #define DEFAULT_HOST_PORT                        "localhost:8773"
@@ -124,6 +151,24 @@
 #define CAN_GZIP
 #endif /* ZLIB_VERNUM && (ZLIB_VERNUM >= 0x1204) */
 
+#ifdef _BENCHMARK
+#if !defined(CAN_GZIP)
+#error "the benchmark needs zlib, to compress and unbundle the images it serves"
+#endif /* ! CAN_GZIP */
+#define BENCH_DEFAULT_SIZES                      "64,256"   //!< image sizes in MB, 256 being where http_get_ranges() starts splitting
+#define BENCH_DEFAULT_OPS                        "write,http_get,http_get_ranges,object,image_gz,unbundle,dd,http_put"
+#define BENCH_DEFAULT_RUNS                       3
+#define BENCH_DEFAULT_ZERO_PERCENT               50 //!< share of an image that is zeros, as on a sparse root disk
+#define BENCH_DEFAULT_PART_MB                    10 //!< size of the parts of a bundle, as the bundling tools make them
+#define BENCH_DEFAULT_STREAMS                    4  //!< ranges that http_get_ranges() downloads at once
+#define BENCH_MAX_SIZES                          16
+#define BENCH_MAX_OBJECTS                        4096
+#define BENCH_SEND_BYTES                         65536  //!< bytes the mock server sends between checks of its bandwidth
+#define BENCH_REQUEST_BYTES                      16384  //!< room for the request line and the headers of a request to the mock server
+#define BENCH_RSA_BITS                           2048
+#define BENCH_AES_KEY_BYTES                      16     //!< AES-128-CBC, which the bundling tools use
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -136,6 +181,14 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! States of a part of a bundle as it goes through the pipeline
+enum bundle_part_state {
+    PART_PENDING = 0,                  //!< waiting to be downloaded (again)
+    PART_FETCHING,                     //!< being downloaded
+    PART_FETCHED,                      //!< in memory, waiting to be unbundled
+    PART_UNPACKED,                     //!< written to the image and freed
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
@@ -147,18 +200,111 @@ struct request {
     int fd;                            //!< output file descriptor to be used by curl WRITERs
     long long total_wrote;             //!< bytes written during the operation
     long long total_calls;             //!< write calls made during the operation
+    char *etag;                        //!< OPTIONAL buffer for the ETag of the response
+    int etag_size;                     //!< size of the etag buffer
+    int io_policy;                     //!< DISKUTIL_IO_POLICY_* flags of the output file
+    long long dropped;                 //!< total_wrote when the output was last dropped from the page cache
 #if defined (CAN_GZIP)
     z_stream strm;                     //!< stream struct used by zlib
     int ret;                           //!< return value of last inflate() call
+    pthread_t inflater;                //!< thread that inflates the stream, off the network thread
+    pthread_mutex_t ring_mutex;        //!< protects the ring and the fields below it
+    pthread_cond_t ring_cond;          //!< signals data or room in the ring
+    unsigned char *ring;               //!< compressed bytes received but not inflated yet
+    long long ring_in;                 //!< bytes put into the ring so far
+    long long ring_out;                //!< bytes taken out of the ring so far
+    boolean ring_eof;                  //!< set once the download is over
+    boolean ring_failed;               //!< set by the inflater on error
+    long long net_wait_usec;           //!< time the network thread waited for room in the ring
+    long long inflate_wait_usec;       //!< time the inflater waited for data from the network
+    long long inflate_usec;            //!< time spent inflating
+    long long write_usec;              //!< time spent writing inflated data
+    diskutil_io *io;                   //!< I/O engine the inflater writes through, if the kernel has one
+    off_t io_base;                     //!< position of fd when the inflater started, where the engine starts writing
 #endif                                 /* CAN_GZIP */
 };
 
+#ifdef _BENCHMARK
+//! Stages of getting an image onto the NC that the benchmark times
+typedef enum _bench_stage {
+    BENCH_STAGE_WRITE = 0,             //!< writing the image from memory, the baseline of the disk
+    BENCH_STAGE_HTTP_GET,              //!< http_get(), as url_creator() does
+    BENCH_STAGE_HTTP_GET_RANGES,       //!< http_get_ranges()
+    BENCH_STAGE_OBJECT,                //!< objectstorage_object_by_url()
+    BENCH_STAGE_IMAGE_GZ,              //!< objectstorage_image_by_manifest_url() with compression, as objectstorage_creator() does
+    BENCH_STAGE_UNBUNDLE,              //!< objectstorage_unbundle_by_manifest_url(), which decrypts and untars on the NC
+    BENCH_STAGE_DD,                    //!< diskutil_dd() of the image, as copies of images do
+    BENCH_STAGE_HTTP_PUT,              //!< http_put(), as uploads do
+    BENCH_STAGES
+} bench_stage;
+
+//! An object that the mock object storage serves
+typedef struct _bench_object {
+    char path[STRSIZE];                //!< path of the URL, without the query
+    boolean compressed;                //!< served to requests with IsCompressed=true, as the object storage does
+    const unsigned char *data;
+    long long len;
+} bench_object;
+
+//! What the inflaters of compressed downloads report, summed up, for the benchmark
+typedef struct _bench_inflate_stats {
+    long long in_bytes;                //!< compressed bytes received
+    long long out_bytes;               //!< inflated bytes written
+    long long net_wait_usec;           //!< time the network waited on the inflater
+    long long inflate_usec;
+    long long inflate_wait_usec;       //!< time the inflater waited on the network
+    long long write_usec;
+} bench_inflate_stats;
+#endif /* _BENCHMARK */
+
 //! Defines the struct for passing information into curl progress function
 struct progress_data_t {
     char *url;
     time_t last_update;
 };
 
+//! One part of a bundled image on its way through the pipeline
+struct bundle_part {
+    char url[STRSIZE];                 //!< where the part is downloaded from
+    enum bundle_part_state state;      //!< where the part is in the pipeline
+    int attempts;                      //!< downloads attempted so far
+    time_t not_before;                 //!< when the next attempt may start
+    unsigned char *buf;                //!< the encrypted bytes of the part
+    size_t len;                        //!< bytes in buf
+    size_t max;                        //!< size of buf
+    CURL *curl;                        //!< handle of the download in progress
+    struct curl_slist *headers;        //!< signed headers of the download in progress
+    char error_msg[CURL_ERROR_SIZE];   //!< error message of the last download
+};
+
+#if defined (CAN_GZIP)
+//! State shared by the download and unbundling stages of a streamed image
+struct bundle_pipeline {
+    struct bundle_part *parts;         //!< parts of the bundle, in order
+    int parts_size;                    //!< number of parts
+    int next_unpacked;                 //!< first part that is not unbundled yet
+    boolean failed;                    //!< set by either stage to stop the other
+    int unpack_ret;                    //!< result of the unbundling stage
+    pthread_mutex_t mutex;             //!< protects the fields above and the states of the parts
+    pthread_cond_t cond;               //!< signals changes in the state of parts
+    const EVP_CIPHER *alg;             //!< the cipher of the bundle
+    EVP_CIPHER_CTX *cipher;            //!< decryption state
+    unsigned char dec[CHUNK + EVP_MAX_BLOCK_LENGTH];    //!< decrypted bytes on their way to inflate()
+    z_stream strm;                     //!< decompression state
+    int ret;                           //!< return value of last inflate() call
+    unsigned char header[TAR_BLOCK];   //!< tar header being assembled
+    int header_len;                    //!< bytes in header
+    long long entry_left;              //!< bytes left in the data of the current tar entry
+    long long entry_pad;               //!< bytes of padding left after the current tar entry
+    boolean in_image;                  //!< whether the current tar entry is the image
+    boolean image_done;                //!< whether all of the image has been written
+    int fd;                            //!< the image file
+    int io_policy;                     //!< DISKUTIL_IO_POLICY_* flags of the image file
+    long long image_wrote;             //!< bytes of the image written
+    long long dropped;                 //!< image_wrote when the image was last dropped from the page cache
+};
+#endif /* CAN_GZIP */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -183,6 +329,15 @@ struct progress_data_t {
 static pthread_mutex_t wreq_mutex = PTHREAD_MUTEX_INITIALIZER;
 static unsigned short total_attempts = TOTAL_ATTEMPTS;
 
+#ifdef _BENCHMARK
+static const char *bench_stage_names[BENCH_STAGES] = { "write", "http_get", "http_get_ranges", "object", "image_gz", "unbundle", "dd", "http_put" };
+static bench_object bench_objects[BENCH_MAX_OBJECTS] = { {{0}} };
+static int bench_objects_len = 0;
+static long long bench_bandwidth = 0;  //!< bytes per second that the mock server sends or receives on a connection, 0 for no limit
+static int bench_latency_ms = 0;       //!< delay of the mock server before it answers a request
+static bench_inflate_stats bench_inflated = { 0 };
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -190,18 +345,51 @@ static unsigned short total_attempts = TOTAL_ATTEMPTS;
 \*----------------------------------------------------------------------------*/
 
 static int objectstorage_request_timeout(const char *objectstorage_op, const char *verb, const char *requested_url, const char *outfile, const int do_compress,
-                                         int connect_timeout, int total_timeout);
+                                         int connect_timeout, int total_timeout, const char *etag, char *new_etag, int new_etag_size, boolean * not_modified);
+static struct curl_slist *objectstorage_signed_headers(const char *objectstorage_op, const char *verb, const char *url);
 static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
+static void request_drop_behind(struct request *req);
 
 #if defined(CAN_GZIP)
 static void print_data(unsigned char *buf, const int size);
 static void zerr(int ret, char *where);
 static size_t write_data_zlib(void *buffer, size_t size, size_t nmemb, void *params);
+static void *inflater_thread(void *arg);
+static int inflater_start(struct request *params);
+static int inflater_finish(struct request *params, const char *url);
+static const char *bundle_xml_value(const char *start, const char *tag, char *value, int value_size);
+static int bundle_decrypt_key(const char *hex_in, const char *pk_file, unsigned char *out, int out_size);
+static size_t write_part(void *buffer, size_t size, size_t nmemb, void *params);
+static int bundle_untar(struct bundle_pipeline *p, const unsigned char *data, size_t len);
+static int bundle_unpack(struct bundle_pipeline *p, const unsigned char *data, size_t len);
+static void *bundle_unpack_thread(void *arg);
+static int bundle_fetch_parts(struct bundle_pipeline *p, const char *url);
 #endif /* CAN_GZIP */
 
 static int progress_function(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 
+#ifdef _BENCHMARK
+static long long bench_cpu_usec(int who);
+static int bench_compare(const void *a, const void *b);
+static void bench_fill(unsigned char *buf, long long len, int zero_percent);
+static unsigned char *bench_gzip(const unsigned char **pieces, const long long *lens, int count, long long *out_len);
+static void bench_tar_header(unsigned char *header, const char *name, long long size);
+static int bench_mkdirs(const char *path);
+static RSA *bench_make_keys(const char *euca_dir, char *pk_file, int pk_file_size);
+static char *bench_encrypt_hex(RSA * rsa, const unsigned char *bytes, int len);
+static unsigned char *bench_make_bundle(const unsigned char *image, long long size, RSA * rsa, long long part_bytes, long long *bundle_len, char **manifest);
+static void bench_add_object(const char *path, boolean compressed, const unsigned char *data, long long len);
+static int bench_send(int fd, const unsigned char *data, long long len);
+static void *bench_serve_request(void *arg);
+static pid_t bench_server_start(int *port);
+static int bench_verify(const char *path, const unsigned char *image, long long size);
+static int bench_run(bench_stage stage, const char *base_url, const char *dir, const char *pk_file, const unsigned char *image, long long size, int streams);
+static void bench_report(FILE * out, bench_stage stage, const char *config, long long size, long long *usec, int runs, int failed, long long cpu_usec,
+                         long long child_cpu_usec, const bench_inflate_stats * inflated);
+static int do_benchmark(int argc, char **argv);
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -226,33 +414,34 @@ static int progress_function(void *clientp, double dltotal, double dlnow, double
 //! @param[in] do_compress
 //! @param[in] connect_timeout
 //! @param[in] total_timeout
+//! @param[in] etag OPTIONAL ETag of a copy the caller has, to send as If-None-Match
+//! @param[out] new_etag OPTIONAL buffer for the ETag of the response, set to "" if there was none
+//! @param[in] new_etag_size
+//! @param[out] not_modified OPTIONAL set to TRUE if the server confirmed that the copy with etag is current, in which case outfile is left empty
 //!
 //! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_ERROR.
 //!
 static int objectstorage_request_timeout(const char *objectstorage_op, const char *verb, const char *requested_url, const char *outfile, const int do_compress,
-                                         int connect_timeout, int total_timeout)
+                                         int connect_timeout, int total_timeout, const char *etag, char *new_etag, int new_etag_size, boolean * not_modified)
 {
     int fd = -1;
     int code = EUCA_ERROR;
     int timeout = FIRST_TIMEOUT;
     long httpcode = 0;
+    long long resume_from = 0;         // bytes of content that earlier attempts wrote, if not compressed
     char *url_path = NULL;
-    char *newline = NULL;
-    char *url_host = NULL;
-    char *auth_str = NULL;
-    char host_hdr[STRSIZE] = "";
-    char date_hdr[STRSIZE] = "";
-    char date_str[17] = "";
     char url[BUFSIZE] = "";
-    char op_hdr[STRSIZE] = "";
     char error_msg[CURL_ERROR_SIZE] = "";
     CURL *curl = 0;
     CURLcode result = CURLE_OK;
-    time_t t = 0;
-    struct tm tmp_t = { 0 };
     struct request params = { 0 };
     struct curl_slist *headers = NULL; // beginning of a DLL with headers
 
+    if (not_modified)
+        *not_modified = FALSE;
+    if (new_etag && (new_etag_size > 0))
+        new_etag[0] = '\0';
+
     pthread_mutex_lock(&wreq_mutex);   // lock for curl construction
 
     euca_strncpy(url, requested_url, BUFSIZE);
@@ -336,6 +525,7 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     }
     // set up the default write function, but possibly override it below, if compression is desired and possible
     params.fd = fd;
+    params.io_policy = diskutil_get_io_policy(outfile);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &params);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
 #if defined(CAN_GZIP)
@@ -344,51 +534,25 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     }
 #endif
 
-    if (objectstorage_op != NULL) {
-        snprintf(op_hdr, STRSIZE, "EucaOperation: %s", objectstorage_op);
-        headers = curl_slist_append(headers, op_hdr);
-    }
-
-    t = time(&t);
-    gmtime_r(&t, &tmp_t);
-
-    //Format for time
-    if (strftime(date_str, 17, "%Y%m%dT%H%M%SZ", &tmp_t) == 0) {
+    // create objectstorage-compliant sig
+    if ((headers = objectstorage_signed_headers(objectstorage_op, verb, url)) == NULL) {
         close(fd);
+        curl_easy_cleanup(curl);
         pthread_mutex_unlock(&wreq_mutex);
         return (EUCA_ERROR);
     }
 
-    assert(strlen(date_str) + 7 <= STRSIZE);
-
-    // remove newline if found
-    if ((newline = strchr(date_str, '\n')) != NULL) {
-        *newline = '\0';
-    }
-
-    snprintf(date_hdr, STRSIZE, "Date: %s", date_str);
-    headers = curl_slist_append(headers, date_hdr);
-
-    if ((url_host = process_url(url, URL_HOSTNAME)) == NULL) {
-        LOGERROR("objectstorage URL has no host\n");
-        pthread_mutex_unlock(&wreq_mutex);
-        return code;
+    // ask for the content only if it differs from the copy the caller has
+    if (etag && etag[0] && ((strlen(etag) + 16) < STRSIZE)) {
+        char etag_hdr[STRSIZE] = "";
+        snprintf(etag_hdr, sizeof(etag_hdr), "If-None-Match: %s", etag);
+        headers = curl_slist_append(headers, etag_hdr);
     }
-
-    snprintf(host_hdr, STRSIZE, "Host: %s", url_host);
-    headers = curl_slist_append(headers, host_hdr);
-
-    // create objectstorage-compliant sig
-    if ((auth_str = eucav2_sign_request(verb, url, headers)) == NULL) {
-        close(fd);
-        pthread_mutex_unlock(&wreq_mutex);
-        EUCA_FREE(url_host);
-        return (EUCA_ERROR);
+    if (new_etag && (new_etag_size > 0)) {
+        params.etag = new_etag;
+        params.etag_size = new_etag_size;
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &params);
     }
-
-    assert(strlen(auth_str) + 16 <= BUFSIZE);
-    headers = curl_slist_append(headers, auth_str);
-
     // register headers
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     if (objectstorage_op) {
@@ -402,6 +566,7 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
     for (int attempt = 1; attempt <= total_attempts; attempt++) {
         params.total_wrote = 0L;
         params.total_calls = 0L;
+        params.dropped = 0L;
 #if defined(CAN_GZIP)
         if (do_compress) {
             // allocate zlib inflate state
@@ -415,6 +580,10 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
                 zerr(params.ret, "objectstorage_request");
                 break;
             }
+            if (inflater_start(&params) != EUCA_OK) {
+                inflateEnd(&(params.strm));
+                break;
+            }
         }
 #endif
 
@@ -424,11 +593,17 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
         //! the library. For now, we will serialize all curl operations, but in the future
         //! an approach to parallelizing objectstorage downloads is necessary
         LOGINFO("downloading %s\n", url);
+        curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t) resume_from);
+        httpcode = 0;
         result = curl_easy_perform(curl);   // do it
-        LOGDEBUG("wrote %lld byte(s) in %lld write(s)\n", params.total_wrote, params.total_calls);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
 
 #if defined(CAN_GZIP)
         if (do_compress) {
+            if ((inflater_finish(&params, url) != EUCA_OK) && (result == CURLE_OK)) {
+                result = CURLE_WRITE_ERROR;
+                euca_strncpy(error_msg, "failed to write decompressed data", sizeof(error_msg));
+            }
             inflateEnd(&(params.strm));
             if (params.ret != Z_STREAM_END) {
                 zerr(params.ret, "objectstorage_request");
@@ -436,19 +611,40 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
         }
 #endif
 
+        LOGDEBUG("wrote %lld byte(s) in %lld write(s)\n", params.total_wrote, params.total_calls);
         boolean bail = FALSE;
 
-        if (result) {                  // curl error (connection or transfer failed)
+        if ((resume_from > 0) && ((result == CURLE_RANGE_ERROR) || (httpcode == 416L))) {
+            LOGWARN("objectstorage cannot resume the download of %s at byte %lld, starting over\n", url, resume_from);
+            resume_from = 0;
+            lseek(fd, 0L, SEEK_SET);
+            attempt--;                 // this one does not count, since it did not download anything
+            continue;
+        } else if (result) {           // curl error (connection or transfer failed)
             LOGERROR("connection to objectstorage failed: %s (%d)\n", error_msg, result);
+            if (!do_compress && ((httpcode == 200L) || (httpcode == 206L))) {
+                resume_from += params.total_wrote;  // what was written is content, so the next attempt can pick up from there
+            } else {
+                resume_from = 0;
+            }
         } else {
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
+            resume_from = 0;           // the response was an error, which is not content
             //! @todo pull out response message, too
 
             switch (httpcode) {
             case 200L:                // all good
+            case 206L:                // the rest of the content, after a resumed attempt
                 LOGINFO("downloaded %s\n", outfile);
                 code = EUCA_OK;
                 break;
+            case 304L:                // only possible with If-None-Match, so the copy with that ETag is current
+                LOGDEBUG("content of %s has not changed\n", url);
+                if (not_modified)
+                    *not_modified = TRUE;
+                if (new_etag && (new_etag_size > 0))
+                    euca_strncpy(new_etag, etag, new_etag_size);
+                code = EUCA_OK;
+                break;
             case 408L:                // timeout, retry
                 LOGWARN("server responded with HTTP code %ld (timeout) for %s\n", httpcode, url);
                 break;
@@ -469,9 +665,16 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
             if (timeout > MAX_TIMEOUT)
                 timeout = MAX_TIMEOUT;
 
-            lseek(fd, 0L, SEEK_SET);   // move the file pointer to the beginning for the retry
+            if (resume_from > 0) {
+                LOGINFO("will resume the download of %s at byte %lld\n", url, resume_from);
+            } else if (new_etag && (new_etag_size > 0)) {
+                new_etag[0] = '\0';
+            }
+            lseek(fd, resume_from, SEEK_SET);   // move the file pointer to where the retry writes
         }
     }
+    if ((code == EUCA_OK) && (params.io_policy & DISKUTIL_IO_POLICY_DONTNEED))
+        diskutil_drop_behind(fd, 0, 0);
     close(fd);
 
     if (code != EUCA_OK) {
@@ -479,14 +682,80 @@ static int objectstorage_request_timeout(const char *objectstorage_op, const cha
         remove(outfile);
     }
 
-    EUCA_FREE(auth_str);
-    EUCA_FREE(url_host);
     curl_slist_free_all(headers);
     curl_easy_cleanup(curl);
     pthread_mutex_unlock(&wreq_mutex);
     return (code);
 }
 
+//!
+//! Builds the headers of an objectstorage request, including the EucaV2 signature of it
+//!
+//! @param[in] objectstorage_op OPTIONAL operation to put in the EucaOperation header
+//! @param[in] verb
+//! @param[in] url
+//!
+//! @return the list of headers, which the caller must free with curl_slist_free_all(), or NULL on error
+//!
+static struct curl_slist *objectstorage_signed_headers(const char *objectstorage_op, const char *verb, const char *url)
+{
+    char *newline = NULL;
+    char *url_host = NULL;
+    char *auth_str = NULL;
+    char host_hdr[STRSIZE] = "";
+    char date_hdr[STRSIZE] = "";
+    char date_str[17] = "";
+    char op_hdr[STRSIZE] = "";
+    time_t t = 0;
+    struct tm tmp_t = { 0 };
+    struct curl_slist *headers = NULL; // beginning of a DLL with headers
+
+    if (objectstorage_op != NULL) {
+        snprintf(op_hdr, STRSIZE, "EucaOperation: %s", objectstorage_op);
+        headers = curl_slist_append(headers, op_hdr);
+    }
+
+    t = time(&t);
+    gmtime_r(&t, &tmp_t);
+
+    //Format for time
+    if (strftime(date_str, 17, "%Y%m%dT%H%M%SZ", &tmp_t) == 0) {
+        curl_slist_free_all(headers);
+        return (NULL);
+    }
+
+    assert(strlen(date_str) + 7 <= STRSIZE);
+
+    // remove newline if found
+    if ((newline = strchr(date_str, '\n')) != NULL) {
+        *newline = '\0';
+    }
+
+    snprintf(date_hdr, STRSIZE, "Date: %s", date_str);
+    headers = curl_slist_append(headers, date_hdr);
+
+    if ((url_host = process_url(url, URL_HOSTNAME)) == NULL) {
+        LOGERROR("objectstorage URL has no host\n");
+        curl_slist_free_all(headers);
+        return (NULL);
+    }
+
+    snprintf(host_hdr, STRSIZE, "Host: %s", url_host);
+    headers = curl_slist_append(headers, host_hdr);
+    EUCA_FREE(url_host);
+
+    // create objectstorage-compliant sig
+    if ((auth_str = eucav2_sign_request(verb, url, headers)) == NULL) {
+        curl_slist_free_all(headers);
+        return (NULL);
+    }
+
+    assert(strlen(auth_str) + 16 <= BUFSIZE);
+    headers = curl_slist_append(headers, auth_str);
+    EUCA_FREE(auth_str);
+    return (headers);
+}
+
 //!
 //! Sets the maximum number of connection attempts that the library will make
 //! to objectstorage. The default is MAX_ATTEMPTS value defined above. The attempts
@@ -518,7 +787,7 @@ int objectstorage_set_max_download_attempts(unsigned short new_max_attempts)
 //!
 int objectstorage_object_by_url(const char *url, const char *outfile, const int do_compress)
 {
-    return objectstorage_request_timeout(NULL, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC);
+    return objectstorage_request_timeout(NULL, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC, NULL, NULL, 0, NULL);
 }
 
 //!
@@ -555,7 +824,7 @@ int objectstorage_object_by_path(const char *path, const char *outfile, const in
 //!
 int objectstorage_image_by_manifest_url(const char *url, const char *outfile, const int do_compress)
 {
-    return objectstorage_request_timeout(GET_IMAGE_CMD, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC);
+    return objectstorage_request_timeout(GET_IMAGE_CMD, "GET", url, outfile, do_compress, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC, NULL, NULL, 0, NULL);
 }
 
 //!
@@ -592,6 +861,26 @@ int objectstorage_image_by_manifest_path(const char *manifest_path, const char *
 //!
 char *objectstorage_get_digest(const char *url)
 {
+    return (objectstorage_get_digest_etag(url, NULL, NULL, 0, NULL));
+}
+
+//!
+//! downloads a digest and returns it as a new string (or NULL if error or if the
+//! copy the caller has is current) that the caller must free
+//!
+//! @param[in]  url
+//! @param[in]  etag OPTIONAL ETag of the copy of the digest the caller has
+//! @param[out] new_etag OPTIONAL buffer for the ETag of the digest, "" if the server sent none
+//! @param[in]  new_etag_size
+//! @param[out] not_modified OPTIONAL set to TRUE if the copy with etag is current, in which case NULL is returned
+//!
+//! @return the digested string.
+//!
+//! @see objectstorage_get_digest()
+//!
+char *objectstorage_get_digest_etag(const char *url, const char *etag, char *new_etag, int new_etag_size, boolean * not_modified)
+{
+    boolean is_current = FALSE;
     char *digest_str = NULL;
     char *digest_path = strdup("/tmp/objectstorage-digest-XXXXXX");
 
@@ -607,11 +896,13 @@ char *objectstorage_get_digest(const char *url)
         close(tmp_fd);                 // objectstorage_ routine will reopen the file
 
         // download a fresh digest
-        if (objectstorage_object_by_url(url, digest_path, 0) != 0) {
+        if (objectstorage_request_timeout(NULL, "GET", url, digest_path, 0, CONNECT_TIMEOUT_SEC, TOTAL_TIMEOUT_SEC, etag, new_etag, new_etag_size, &is_current) != 0) {
             LOGERROR("failed to download digest to %s\n", digest_path);
-        } else {
+        } else if (!is_current) {
             digest_str = file2strn(digest_path, 2000000);
         }
+        if (not_modified)
+            *not_modified = is_current;
         unlink(digest_path);
     }
     EUCA_FREE(digest_path);
@@ -652,6 +943,176 @@ int objectstorage_verify_digest(const char *url, const char *old_digest_path)
     return e;
 }
 
+//!
+//! Downloads a bundled image, given the URL of its manifest, and unbundles it into outfile
+//! as it arrives: several parts of the bundle are downloaded at once while another thread
+//! decrypts, decompresses and untars the parts that are in, in order, writing the image
+//! straight into the file. Unlike objectstorage_image_by_manifest_url(), this needs neither
+//! the objectstorage to decrypt the image nor the disk space for the bundle.
+//!
+//! @param[in] url of the manifest
+//! @param[in] pk_file private key of the cloud, which the key of the bundle is encrypted for
+//! @param[in] outfile must exist and have room for the image
+//! @param[in] size_bytes expected size of the image, or 0 if unknown
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_ERROR,
+//!         EUCA_INVALID_ERROR for a manifest that cannot be streamed and EUCA_UNSUPPORTED_ERROR
+//!         when built without zlib.
+//!
+int objectstorage_unbundle_by_manifest_url(const char *url, const char *pk_file, const char *outfile, long long size_bytes)
+{
+#if defined(CAN_GZIP)
+    int ret = EUCA_ERROR;
+    int key_len = 0;
+    int iv_len = 0;
+    int base_len = 0;
+    long long image_size = 0;
+    char *manifest = NULL;
+    char *hex = NULL;
+    const char *pos = NULL;
+    const char *slash = NULL;
+    char value[STRSIZE] = "";
+    char filename[STRSIZE] = "";
+    unsigned char key[EVP_MAX_KEY_LENGTH] = { 0 };
+    unsigned char iv[EVP_MAX_IV_LENGTH] = { 0 };
+    struct bundle_pipeline *p = NULL;
+    pthread_t unpacker = { 0 };
+
+    if ((url == NULL) || (pk_file == NULL) || (outfile == NULL) || ((slash = strrchr(url, '/')) == NULL))
+        return (EUCA_INVALID_ERROR);
+    base_len = slash - url + 1;        // parts sit next to the manifest
+
+    if ((manifest = objectstorage_get_digest(url)) == NULL) {
+        LOGERROR("failed to download manifest %s\n", url);
+        return (EUCA_ERROR);
+    }
+
+    if ((p = EUCA_ZALLOC(1, sizeof(struct bundle_pipeline))) == NULL) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(manifest);
+        return (EUCA_ERROR);
+    }
+    p->fd = -1;
+    pthread_mutex_init(&(p->mutex), NULL);
+    pthread_cond_init(&(p->cond), NULL);
+
+    // pick the size of the image, the encrypted key and the parts out of the manifest
+    if (((pos = strstr(manifest, "<image>")) == NULL) || (bundle_xml_value(pos, "size", value, sizeof(value)) == NULL)
+        || ((image_size = strtoll(value, NULL, 10)) <= 0)) {
+        LOGERROR("no image size in manifest %s\n", url);
+        ret = EUCA_INVALID_ERROR;
+        goto cleanup;
+    }
+    if ((size_bytes > 0) && (image_size != size_bytes)) {
+        LOGERROR("image in manifest %s has %lld bytes instead of the expected %lld\n", url, image_size, size_bytes);
+        ret = EUCA_INVALID_ERROR;
+        goto cleanup;
+    }
+    if (((hex = EUCA_ALLOC(BUFSIZE, 1)) == NULL) || (bundle_xml_value(manifest, "ec2_encrypted_key", hex, BUFSIZE) == NULL)
+        || ((key_len = bundle_decrypt_key(hex, pk_file, key, sizeof(key))) <= 0) || (bundle_xml_value(manifest, "ec2_encrypted_iv", hex, BUFSIZE) == NULL)
+        || ((iv_len = bundle_decrypt_key(hex, pk_file, iv, sizeof(iv))) <= 0)) {
+        LOGERROR("failed to get the key of the bundle out of manifest %s\n", url);
+        goto cleanup;
+    }
+    if ((key_len == 16) && (iv_len == 16)) {
+        p->alg = EVP_aes_128_cbc();
+    } else if ((key_len == 32) && (iv_len == 16)) {
+        p->alg = EVP_aes_256_cbc();
+    } else {
+        LOGERROR("unsupported cipher in manifest %s (%d-byte key)\n", url, key_len);
+        ret = EUCA_INVALID_ERROR;
+        goto cleanup;
+    }
+
+    for (pos = strstr(manifest, "<part "); pos; pos = strstr(pos, "<part ")) {
+        int index = -1;
+        if ((sscanf(pos, "<part index=\"%d\"", &index) != 1) || (index != p->parts_size) || ((pos = bundle_xml_value(pos, "filename", filename, sizeof(filename))) == NULL)
+            || ((base_len + strlen(filename)) >= STRSIZE)) {
+            LOGERROR("unexpected part %d in manifest %s\n", p->parts_size, url);
+            ret = EUCA_INVALID_ERROR;
+            goto cleanup;
+        }
+        struct bundle_part *parts = realloc(p->parts, (p->parts_size + 1) * sizeof(struct bundle_part));
+        if (parts == NULL) {
+            LOGERROR("out of memory\n");
+            goto cleanup;
+        }
+        p->parts = parts;
+        bzero(&(p->parts[p->parts_size]), sizeof(struct bundle_part));
+        snprintf(p->parts[p->parts_size].url, STRSIZE, "%.*s%s", base_len, url, filename);
+        p->parts_size++;
+    }
+    if (p->parts_size == 0) {
+        LOGERROR("no parts in manifest %s\n", url);
+        ret = EUCA_INVALID_ERROR;
+        goto cleanup;
+    }
+
+    if ((p->fd = open(outfile, O_WRONLY)) == -1) {
+        LOGERROR("failed to open %s for writing\n", outfile);
+        goto cleanup;
+    }
+    p->io_policy = diskutil_get_io_policy(outfile);
+    if (((p->cipher = EVP_CIPHER_CTX_new()) == NULL) || !EVP_DecryptInit_ex(p->cipher, p->alg, NULL, key, iv)) {
+        LOGERROR("failed to set up decryption of the bundle\n");
+        goto cleanup;
+    }
+    if (inflateInit2(&(p->strm), (16 + MAX_WBITS)) != Z_OK) {  // bundles are gzip'ed
+        LOGERROR("failed to initialize decompression\n");
+        goto cleanup;
+    }
+
+    LOGINFO("streaming %d parts of %s into %s\n", p->parts_size, url, outfile);
+    if (pthread_create(&unpacker, NULL, bundle_unpack_thread, p)) {
+        LOGERROR("failed to start unbundling thread\n");
+        inflateEnd(&(p->strm));
+        goto cleanup;
+    }
+
+    pthread_mutex_lock(&wreq_mutex);   // see the note in objectstorage_request_timeout()
+    ret = bundle_fetch_parts(p, url);
+    pthread_mutex_unlock(&wreq_mutex);
+
+    pthread_mutex_lock(&(p->mutex));
+    if (ret != EUCA_OK)
+        p->failed = TRUE;
+    pthread_cond_broadcast(&(p->cond));
+    pthread_mutex_unlock(&(p->mutex));
+    pthread_join(unpacker, NULL);
+    inflateEnd(&(p->strm));
+
+    if ((ret == EUCA_OK) && ((ret = p->unpack_ret) == EUCA_OK)) {
+        if (p->image_wrote != image_size) {
+            LOGERROR("unbundled %lld bytes of a %lld-byte image from %s\n", p->image_wrote, image_size, url);
+            ret = EUCA_ERROR;
+        } else {
+            LOGINFO("unbundled %lld bytes of %s into %s\n", p->image_wrote, url, outfile);
+            if (p->io_policy & DISKUTIL_IO_POLICY_DONTNEED)
+                diskutil_drop_behind(p->fd, 0, 0);
+        }
+    }
+
+cleanup:
+    if (p->fd != -1)
+        close(p->fd);
+    if (p->cipher)
+        EVP_CIPHER_CTX_free(p->cipher);
+    for (int i = 0; i < p->parts_size; i++)
+        EUCA_FREE(p->parts[i].buf);
+    EUCA_FREE(p->parts);
+    pthread_cond_destroy(&(p->cond));
+    pthread_mutex_destroy(&(p->mutex));
+    EUCA_FREE(p);
+    EUCA_FREE(hex);
+    EUCA_FREE(manifest);
+    bzero(key, sizeof(key));
+    return (ret);
+#else /* CAN_GZIP */
+    LOGERROR("cannot unbundle images without zlib\n");
+    return (EUCA_UNSUPPORTED_ERROR);
+#endif /* CAN_GZIP */
+}
+
 //!
 //! libcurl header write handler
 //!
@@ -664,7 +1125,20 @@ int objectstorage_verify_digest(const char *url, const char *old_digest_path)
 //!
 static size_t write_header(void *buffer, size_t size, size_t nmemb, void *params)
 {
-    /* here in case we want to do something with headers */
+    struct request *req = params;
+    size_t len = size * nmemb;
+    const char *val = buffer;
+
+    // pick out the ETag, if the caller wants it (params is NULL otherwise)
+    if ((req != NULL) && (req->etag != NULL) && (len > 5) && !strncasecmp(buffer, "ETag:", 5)) {
+        for (val += 5, len -= 5; (len > 0) && isspace(*val); val++, len--) ;
+        while ((len > 0) && isspace(val[len - 1]))
+            len--;
+        if (len < req->etag_size) {
+            memcpy(req->etag, val, len);
+            req->etag[len] = '\0';
+        }
+    }
     return (size * nmemb);
 }
 
@@ -687,10 +1161,35 @@ static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params)
     int wrote = write(fd, buffer, size * nmemb);    // any blocking in this call is not subject to connection timeouts
     ((struct request *)params)->total_wrote += wrote;
     ((struct request *)params)->total_calls++;
+    request_drop_behind((struct request *)params);
 
     return wrote;
 }
 
+//!
+//! Drops what a download has written from the page cache every DROP_BEHIND_BYTES,
+//! if the I/O policy of the output file asks for it
+//!
+//! @param[in] req the request
+//!
+static void request_drop_behind(struct request *req)
+{
+    off_t end = 0;
+
+    if (!(req->io_policy & DISKUTIL_IO_POLICY_DONTNEED) || ((req->total_wrote - req->dropped) < DROP_BEHIND_BYTES))
+        return;
+
+#if defined(CAN_GZIP)
+    if (req->io)
+        end = req->io_base + req->total_wrote;  // the engine does not move the file position
+#endif /* CAN_GZIP */
+    if ((end == 0) && ((end = lseek(req->fd, 0, SEEK_CUR)) <= 0))
+        return;
+
+    req->dropped = req->total_wrote;
+    diskutil_drop_behind(req->fd, end, DROP_BEHIND_BYTES);
+}
+
 #if defined(CAN_GZIP)
 //!
 //! unused testing function
@@ -739,72 +1238,1619 @@ static void zerr(int ret, char *where)
 }
 
 //!
-//! libcurl write handler for gzipped streams
+//! libcurl write handler for gzipped streams, which only queues the data for inflater_thread()
+//! so that decompression does not hold up the network
 //!
 //! @param[in] buffer
 //! @param[in] size
 //! @param[in] nmemb
 //! @param[in] params
 //!
-//! @return the number of bytes written. If the returned value does not match
+//! @return the number of bytes taken. If the returned value does not match
 //!         size*nmemb, then libcurl will return an error.
 //!
 static size_t write_data_zlib(void *buffer, size_t size, size_t nmemb, void *params)
 {
     assert(params != NULL);
-    z_stream *strm = &(((struct request *)params)->strm);
-    int fd = ((struct request *)params)->fd;
-    unsigned char out[CHUNK];
-    int wrote = 0;
-    int ret;
+    struct request *req = params;
+    size_t len = size * nmemb;
+    size_t done = 0;
+    long long started = 0;
 
     // any blocking in this function is not subject to connection timeouts
 
-    strm->avail_in = size * nmemb;
-    strm->next_in = (unsigned char *)buffer;
-    do {
-        strm->avail_out = CHUNK;
-        strm->next_out = out;
-
-        ((struct request *)params)->ret = ret = inflate(strm, Z_NO_FLUSH);
-        switch (ret) {
-        case Z_NEED_DICT:
-            ret = Z_DATA_ERROR;        // ok to fall through
-        case Z_DATA_ERROR:
-        case Z_MEM_ERROR:
-        case Z_STREAM_ERROR:
-            inflateEnd(strm);
-            zerr(ret, "write_data_zlib");
-            return ret;
-        }
-
-        unsigned have = CHUNK - strm->avail_out;
-        if (write(fd, out, have) != have) {
-            LOGERROR("write call with compressed data failed\n");
-            inflateEnd(strm);
-            return Z_ERRNO;
-        }
-        wrote += have;
-    } while (strm->avail_out == 0);
+    pthread_mutex_lock(&(req->ring_mutex));
+    while ((done < len) && !req->ring_failed) {
+        size_t room = INFLATE_RING_BYTES - (req->ring_in - req->ring_out);
+        if (room == 0) {
+            started = mono_time_usec();
+            pthread_cond_wait(&(req->ring_cond), &(req->ring_mutex));
+            req->net_wait_usec += mono_time_usec() - started;
+            continue;
+        }
 
-    ((struct request *)params)->total_wrote += wrote;
-    ((struct request *)params)->total_calls++;
-    return size * nmemb;
+        size_t offset = req->ring_in % INFLATE_RING_BYTES;
+        size_t n = len - done;
+        if (n > room)
+            n = room;
+        if (n > (INFLATE_RING_BYTES - offset))
+            n = INFLATE_RING_BYTES - offset;  // up to the end of the ring, the rest goes at its beginning
+        memcpy(req->ring + offset, ((unsigned char *)buffer) + done, n);
+        req->ring_in += n;
+        done += n;
+        pthread_cond_broadcast(&(req->ring_cond));
+    }
+    pthread_mutex_unlock(&(req->ring_mutex));
+
+    req->total_calls++;
+    return done;
 }
-#endif /* CAN_GZIP */
 
-static int progress_function(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+//!
+//! Inflates what write_data_zlib() puts into the ring and writes it out, until the download is over
+//!
+//! @param[in] arg the request
+//!
+//! @return Always return NULL
+//!
+static void *inflater_thread(void *arg)
 {
-    struct progress_data_t *progress_data = (struct progress_data_t *)clientp;
-    time_t now = time(NULL);
+    struct request *req = arg;
+    z_stream *strm = &(req->strm);
+    unsigned char out[CHUNK];
+    long long started = 0;
+    int ret = Z_OK;
 
-    if (dltotal <= 0.0)                // can't do anything with that
-        return 0;
+    pthread_mutex_lock(&(req->ring_mutex));
+    while (!req->ring_failed) {
+        if (req->ring_in == req->ring_out) {
+            if (req->ring_eof)
+                break;
+            started = mono_time_usec();
+            pthread_cond_wait(&(req->ring_cond), &(req->ring_mutex));
+            req->inflate_wait_usec += mono_time_usec() - started;
+            continue;
+        }
 
-    if ((progress_data->last_update + PROGRESS_UPDATE_SEC) <= now) {
-        double percent = (dlnow / dltotal) * 100.0;
-        LOGINFO("downloaded %.1f%% of %s\n", percent, progress_data->url);
-        progress_data->last_update = now;
+        size_t offset = req->ring_out % INFLATE_RING_BYTES;
+        size_t n = req->ring_in - req->ring_out;
+        if (n > (INFLATE_RING_BYTES - offset))
+            n = INFLATE_RING_BYTES - offset;
+        pthread_mutex_unlock(&(req->ring_mutex));   // the network thread may fill the rest of the ring meanwhile
+
+        strm->avail_in = n;
+        strm->next_in = req->ring + offset;
+        do {
+            strm->avail_out = CHUNK;
+            strm->next_out = out;
+
+            started = mono_time_usec();
+            if ((ret = inflate(strm, Z_NO_FLUSH)) != Z_BUF_ERROR)   // which only means that more input is needed
+                req->ret = ret;
+            req->inflate_usec += mono_time_usec() - started;
+            if ((ret == Z_NEED_DICT) || (ret == Z_DATA_ERROR) || (ret == Z_MEM_ERROR) || (ret == Z_STREAM_ERROR)) {
+                zerr(((ret == Z_NEED_DICT) ? Z_DATA_ERROR : ret), "inflater_thread");
+                break;
+            }
+
+            unsigned have = CHUNK - strm->avail_out;
+            started = mono_time_usec();
+            if (req->io) {
+                // the engine copies the data and gathers it into large writes that go on in the background
+                if (diskutil_io_write(req->io, (char *)out, have, (req->io_base + req->total_wrote)) != EUCA_OK) {
+                    LOGERROR("write call with compressed data failed: %s\n", strerror(errno));
+                    ret = Z_ERRNO;
+                    break;
+                }
+            } else if (write(req->fd, out, have) != have) {
+                LOGERROR("write call with compressed data failed\n");
+                ret = Z_ERRNO;
+                break;
+            }
+            req->total_wrote += have;
+            request_drop_behind(req);
+            req->write_usec += mono_time_usec() - started;
+        } while (strm->avail_out == 0);
+
+        pthread_mutex_lock(&(req->ring_mutex));
+        if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR)) {
+            req->ring_failed = TRUE;
+        }
+        req->ring_out += n;
+        pthread_cond_broadcast(&(req->ring_cond));
     }
-    return 0;
+    pthread_mutex_unlock(&(req->ring_mutex));
+    return NULL;
+}
+
+//!
+//! Sets up the ring and starts the inflater for an attempt at a compressed download
+//!
+//! @param[in] params
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int inflater_start(struct request *params)
+{
+    if ((params->ring = EUCA_ALLOC(INFLATE_RING_BYTES, 1)) == NULL) {
+        LOGERROR("out of memory\n");
+        return (EUCA_ERROR);
+    }
+    params->ring_in = params->ring_out = 0;
+    params->ring_eof = params->ring_failed = FALSE;
+    params->net_wait_usec = params->inflate_wait_usec = params->inflate_usec = params->write_usec = 0;
+    if (((params->io_base = lseek(params->fd, 0, SEEK_CUR)) < 0) || ((params->io = diskutil_io_open(-1, params->fd)) == NULL))
+        params->io = NULL;
+    pthread_mutex_init(&(params->ring_mutex), NULL);
+    pthread_cond_init(&(params->ring_cond), NULL);
+    if (pthread_create(&(params->inflater), NULL, inflater_thread, params)) {
+        LOGERROR("failed to start the inflater thread\n");
+        pthread_cond_destroy(&(params->ring_cond));
+        pthread_mutex_destroy(&(params->ring_mutex));
+        diskutil_io_close(&(params->io));
+        EUCA_FREE(params->ring);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Lets the inflater drain the ring, waits for it and reports how busy each stage of the
+//! download was: a network thread that waits on the ring means that decompression or the
+//! disk is the bottleneck, while an inflater that waits on the ring means the network is.
+//!
+//! @param[in] params
+//! @param[in] url for the log
+//!
+//! @return EUCA_OK if everything that was received got inflated and written or EUCA_ERROR otherwise
+//!
+static int inflater_finish(struct request *params, const char *url)
+{
+    int ret = EUCA_OK;
+    long long started = 0;
+
+    pthread_mutex_lock(&(params->ring_mutex));
+    params->ring_eof = TRUE;
+    pthread_cond_broadcast(&(params->ring_cond));
+    pthread_mutex_unlock(&(params->ring_mutex));
+    pthread_join(params->inflater, NULL);
+
+    if (params->io) {
+        started = mono_time_usec();
+        if (diskutil_io_flush(params->io) != EUCA_OK) {
+            LOGERROR("write call with compressed data failed: %s\n", strerror(errno));
+            params->ring_failed = TRUE;
+        }
+        params->write_usec += mono_time_usec() - started;
+        diskutil_io_close(&(params->io));
+        // leave the file position where the writes would have left it
+        lseek(params->fd, (params->io_base + params->total_wrote), SEEK_SET);
+    }
+
+    if (params->ring_failed)
+        ret = EUCA_ERROR;
+#ifdef _BENCHMARK
+    bench_inflated.in_bytes += params->ring_in;
+    bench_inflated.out_bytes += params->total_wrote;
+    bench_inflated.net_wait_usec += params->net_wait_usec;
+    bench_inflated.inflate_usec += params->inflate_usec;
+    bench_inflated.inflate_wait_usec += params->inflate_wait_usec;
+    bench_inflated.write_usec += params->write_usec;
+#endif /* _BENCHMARK */
+    LOGDEBUG("received %lld byte(s), waiting %lld ms for the inflater; inflated them into %lld byte(s) with zlib %s in %lld ms, "
+             "waiting %lld ms for the network and %lld ms for writes, for %s\n", params->ring_in, (params->net_wait_usec / 1000), params->total_wrote,
+             zlibVersion(), (params->inflate_usec / 1000), (params->inflate_wait_usec / 1000), (params->write_usec / 1000), url);
+
+    pthread_cond_destroy(&(params->ring_cond));
+    pthread_mutex_destroy(&(params->ring_mutex));
+    EUCA_FREE(params->ring);
+    return (ret);
+}
+
+//!
+//! Finds the text of the first element with the given tag in an XML document, starting
+//! the search at 'start', e.g., to pick values out of an image manifest
+//!
+//! @param[in]  start where to start looking
+//! @param[in]  tag name of the element
+//! @param[out] value buffer for the text of the element, if not NULL
+//! @param[in]  value_size
+//!
+//! @return a pointer to the end of the element within the document or NULL if it was not found (or did not fit)
+//!
+static const char *bundle_xml_value(const char *start, const char *tag, char *value, int value_size)
+{
+    char open_tag[STRSIZE] = "";
+    char close_tag[STRSIZE] = "";
+    const char *s = NULL;
+    const char *e = NULL;
+
+    snprintf(open_tag, sizeof(open_tag), "<%s", tag);
+    snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+    for (s = start; (s = strstr(s, open_tag)) != NULL; s += strlen(open_tag)) {
+        if (s[strlen(open_tag)] == '>' || s[strlen(open_tag)] == ' ')
+            break;                     // not just a tag that this one is a prefix of
+    }
+    if ((s == NULL) || ((s = strchr(s, '>')) == NULL) || ((e = strstr(++s, close_tag)) == NULL))
+        return (NULL);
+    if (value) {
+        if ((e - s) >= value_size)
+            return (NULL);
+        memcpy(value, s, e - s);
+        value[e - s] = '\0';
+    }
+    return (e + strlen(close_tag));
+}
+
+//!
+//! Decrypts a symmetric key (or initialization vector) of a bundle, which the manifest holds
+//! as the hex of its hex, encrypted with the public key of the cloud
+//!
+//! @param[in]  hex_in value from the manifest
+//! @param[in]  pk_file private key of the cloud
+//! @param[out] out buffer for the decrypted bytes
+//! @param[in]  out_size
+//!
+//! @return the number of bytes decrypted or -1 on error
+//!
+static int bundle_decrypt_key(const char *hex_in, const char *pk_file, unsigned char *out, int out_size)
+{
+    int len = 0;
+    int in_len = strlen(hex_in) / 2;
+    unsigned int byte = 0;
+    char *enc64 = NULL;
+    char *hex_out = NULL;
+    unsigned char *in = NULL;
+
+    if ((in = EUCA_ALLOC(in_len + 1, 1)) == NULL)
+        return (-1);
+    for (int i = 0; i < in_len; i++) {
+        if (sscanf(hex_in + (2 * i), "%2x", &byte) != 1) {
+            EUCA_FREE(in);
+            return (-1);
+        }
+        in[i] = byte;
+    }
+
+    // decrypt_string() takes base64, so that is what we give it
+    if (((enc64 = base64_enc(in, in_len)) == NULL) || (decrypt_string(enc64, (char *)pk_file, &hex_out) != EUCA_OK)) {
+        LOGERROR("failed to decrypt the key of the bundle with %s\n", pk_file);
+        len = -1;
+    } else {
+        for (len = 0; (len < out_size) && isxdigit(hex_out[2 * len]) && isxdigit(hex_out[2 * len + 1]); len++) {
+            sscanf(hex_out + (2 * len), "%2x", &byte);
+            out[len] = byte;
+        }
+    }
+    EUCA_FREE(in);
+    EUCA_FREE(enc64);
+    EUCA_FREE(hex_out);
+    return (len);
+}
+
+//!
+//! libcurl write handler that collects a part of a bundle in memory
+//!
+//! @param[in] buffer
+//! @param[in] size
+//! @param[in] nmemb
+//! @param[in] params the bundle_part
+//!
+//! @return the number of bytes taken, which is less than size*nmemb if memory ran out
+//!
+static size_t write_part(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    struct bundle_part *part = params;
+    size_t len = size * nmemb;
+    unsigned char *buf = NULL;
+
+    if ((part->len + len) > part->max) {
+        size_t max = (part->max) ? (part->max) : (BUNDLE_PART_BYTES);
+        while (max < (part->len + len))
+            max *= 2;
+        if ((buf = realloc(part->buf, max)) == NULL)
+            return (0);
+        part->buf = buf;
+        part->max = max;
+    }
+    memcpy(part->buf + part->len, buffer, len);
+    part->len += len;
+    return (len);
+}
+
+//!
+//! Feeds the tar stream of a bundle, as it comes out of the decompressor, into the image file,
+//! writing the content of the first regular file in the archive at its offset in the image
+//!
+//! @param[in] p
+//! @param[in] data
+//! @param[in] len
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the image could not be written
+//!
+static int bundle_untar(struct bundle_pipeline *p, const unsigned char *data, size_t len)
+{
+    size_t n = 0;
+    ssize_t wrote = 0;
+
+    while ((len > 0) && !p->image_done) {
+        if (p->entry_left > 0) {
+            n = (len < p->entry_left) ? len : p->entry_left;
+            if (p->in_image) {
+                if ((wrote = pwrite(p->fd, data, n, p->image_wrote)) != (ssize_t) n) {
+                    LOGERROR("failed to write the image at offset %lld (%s)\n", p->image_wrote, strerror(errno));
+                    return (EUCA_ERROR);
+                }
+                p->image_wrote += n;
+                if ((p->io_policy & DISKUTIL_IO_POLICY_DONTNEED) && ((p->image_wrote - p->dropped) >= DROP_BEHIND_BYTES)) {
+                    p->dropped = p->image_wrote;
+                    diskutil_drop_behind(p->fd, p->image_wrote, DROP_BEHIND_BYTES);
+                }
+            }
+            p->entry_left -= n;
+            if ((p->entry_left == 0) && p->in_image)
+                p->image_done = TRUE;
+        } else if (p->entry_pad > 0) {
+            n = (len < p->entry_pad) ? len : p->entry_pad;
+            p->entry_pad -= n;
+        } else {
+            n = ((TAR_BLOCK - p->header_len) < len) ? (TAR_BLOCK - p->header_len) : len;
+            memcpy(p->header + p->header_len, data, n);
+            if ((p->header_len += n) == TAR_BLOCK) {
+                unsigned char type = p->header[156];
+                long long size = 0;
+
+                p->header_len = 0;
+                if (p->header[0] == '\0')
+                    break;             // the end of the archive
+                if (p->header[124] & 0x80) {    // GNU base-256 encoding, for sizes over 8 GB
+                    size = p->header[124] & 0x7f;
+                    for (int i = 125; i < 136; i++)
+                        size = (size << 8) | p->header[i];
+                } else {
+                    char octal[13] = "";
+                    memcpy(octal, p->header + 124, 12);
+                    size = strtoll(octal, NULL, 8);
+                }
+                p->entry_left = size;
+                p->entry_pad = (TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK;
+                p->in_image = ((type == '0') || (type == '\0'));    // others, such as extended headers, are skipped
+                if (p->in_image && (size == 0))
+                    p->image_done = TRUE;
+            }
+        }
+        data += n;
+        len -= n;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Decrypts and inflates a piece of the bundle, passing whatever comes out on to bundle_untar()
+//!
+//! @param[in] p
+//! @param[in] data encrypted bytes, in order, or NULL to finish decryption
+//! @param[in] len
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the bundle is damaged or the image could not be written
+//!
+static int bundle_unpack(struct bundle_pipeline *p, const unsigned char *data, size_t len)
+{
+    int ret = 0;
+    int dec_len = 0;
+    unsigned char out[CHUNK];
+
+    for (size_t off = 0; (off < len) || (data == NULL); off += CHUNK) {
+        size_t n = ((len - off) < CHUNK) ? (len - off) : CHUNK;
+
+        if (data == NULL) {
+            if (!EVP_DecryptFinal_ex(p->cipher, p->dec, &dec_len)) {
+                LOGERROR("failed to decrypt the end of the bundle\n");
+                return (EUCA_ERROR);
+            }
+        } else if (!EVP_DecryptUpdate(p->cipher, p->dec, &dec_len, data + off, n)) {
+            LOGERROR("failed to decrypt the bundle\n");
+            return (EUCA_ERROR);
+        }
+
+        p->strm.next_in = p->dec;
+        p->strm.avail_in = dec_len;
+        while ((p->strm.avail_in > 0) && (p->ret != Z_STREAM_END)) {
+            p->strm.next_out = out;
+            p->strm.avail_out = CHUNK;
+            if (((ret = inflate(&(p->strm), Z_NO_FLUSH)) != Z_OK) && (ret != Z_STREAM_END)) {
+                zerr(((ret == Z_NEED_DICT) ? Z_DATA_ERROR : ret), "bundle_unpack");
+                return (EUCA_ERROR);
+            }
+            p->ret = ret;
+            if (bundle_untar(p, out, CHUNK - p->strm.avail_out) != EUCA_OK)
+                return (EUCA_ERROR);
+        }
+
+        if (data == NULL)
+            break;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Unbundling stage of the pipeline, which takes the parts in order as they finish downloading
+//!
+//! @param[in] arg the bundle_pipeline
+//!
+//! @return Always return NULL
+//!
+static void *bundle_unpack_thread(void *arg)
+{
+    struct bundle_pipeline *p = arg;
+    struct bundle_part *part = NULL;
+    int ret = EUCA_OK;
+
+    for (int i = 0; (i < p->parts_size) && (ret == EUCA_OK); i++) {
+        part = &(p->parts[i]);
+        pthread_mutex_lock(&(p->mutex));
+        while ((part->state != PART_FETCHED) && !p->failed)
+            pthread_cond_wait(&(p->cond), &(p->mutex));
+        if (p->failed)
+            ret = EUCA_ERROR;
+        pthread_mutex_unlock(&(p->mutex));
+
+        if (ret == EUCA_OK)
+            ret = bundle_unpack(p, part->buf, part->len);
+
+        pthread_mutex_lock(&(p->mutex));
+        EUCA_FREE(part->buf);
+        part->len = part->max = 0;
+        part->state = PART_UNPACKED;
+        p->next_unpacked = i + 1;      // makes room in the window for another part
+        pthread_cond_broadcast(&(p->cond));
+        pthread_mutex_unlock(&(p->mutex));
+    }
+
+    if ((ret == EUCA_OK) && ((ret = bundle_unpack(p, NULL, 0)) == EUCA_OK)) {
+        if ((p->ret != Z_STREAM_END) || !p->image_done) {
+            LOGERROR("bundle ended before the image did (%lld bytes written)\n", p->image_wrote);
+            ret = EUCA_ERROR;
+        }
+    }
+
+    pthread_mutex_lock(&(p->mutex));
+    p->unpack_ret = ret;
+    if (ret != EUCA_OK)
+        p->failed = TRUE;
+    pthread_cond_broadcast(&(p->cond));
+    pthread_mutex_unlock(&(p->mutex));
+    return NULL;
+}
+
+//!
+//! Downloading stage of the pipeline, which keeps up to BUNDLE_FETCHES parts downloading at
+//! once, through a single libcurl multi handle, as long as they are within BUNDLE_WINDOW parts
+//! of the one being unbundled. Failed parts are retried with the same backoff as other requests.
+//!
+//! @param[in] p
+//! @param[in] url of the manifest, for logging
+//!
+//! @return EUCA_OK once all parts have been downloaded or EUCA_ERROR on failure
+//!
+static int bundle_fetch_parts(struct bundle_pipeline *p, const char *url)
+{
+    int ret = EUCA_OK;
+    int active = 0;
+    int running = 0;
+    int fetched = 0;
+    int left = 0;
+    int max_fd = -1;
+    long httpcode = 0;
+    long timeout_ms = 0;
+    time_t now = 0;
+    time_t last_update = time(NULL);
+    fd_set fd_read;
+    fd_set fd_write;
+    fd_set fd_exc;
+    struct timeval tv = { 0 };
+    struct timespec ts = { 0 };
+    struct bundle_part *part = NULL;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+
+    if ((multi = curl_multi_init()) == NULL) {
+        LOGERROR("could not initialize libcurl\n");
+        return (EUCA_ERROR);
+    }
+
+    while ((ret == EUCA_OK) && (fetched < p->parts_size)) {
+        pthread_mutex_lock(&(p->mutex));
+        if (p->failed)
+            ret = EUCA_ERROR;
+        int window_end = p->next_unpacked + BUNDLE_WINDOW;
+        pthread_mutex_unlock(&(p->mutex));
+        if (ret != EUCA_OK)
+            break;
+
+        // start downloading the parts that fit in the window
+        now = time(NULL);
+        for (int i = 0; (i < p->parts_size) && (i < window_end) && (active < BUNDLE_FETCHES); i++) {
+            part = &(p->parts[i]);
+            if ((part->state != PART_PENDING) || (part->not_before > now))
+                continue;
+            if (((part->curl = curl_easy_init()) == NULL) || ((part->headers = objectstorage_signed_headers(NULL, "GET", part->url)) == NULL)) {
+                LOGERROR("failed to set up the download of %s\n", part->url);
+                ret = EUCA_ERROR;
+                break;
+            }
+            part->len = 0;
+            curl_easy_setopt(part->curl, CURLOPT_URL, part->url);
+            curl_easy_setopt(part->curl, CURLOPT_PRIVATE, part);
+            curl_easy_setopt(part->curl, CURLOPT_ERRORBUFFER, part->error_msg);
+            curl_easy_setopt(part->curl, CURLOPT_HEADERFUNCTION, write_header);
+            curl_easy_setopt(part->curl, CURLOPT_WRITEFUNCTION, write_part);
+            curl_easy_setopt(part->curl, CURLOPT_WRITEDATA, part);
+            curl_easy_setopt(part->curl, CURLOPT_HTTPHEADER, part->headers);
+            curl_easy_setopt(part->curl, CURLOPT_HTTPGET, 1L);
+            curl_easy_setopt(part->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(part->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+            curl_easy_setopt(part->curl, CURLOPT_LOW_SPEED_LIMIT, 360L);
+            curl_easy_setopt(part->curl, CURLOPT_LOW_SPEED_TIME, 10L);
+            curl_easy_setopt(part->curl, CURLOPT_FOLLOWLOCATION, 1);
+            curl_easy_setopt(part->curl, CURLOPT_CONNECTTIMEOUT, CONNECT_TIMEOUT_SEC);
+            curl_multi_add_handle(multi, part->curl);
+            part->state = PART_FETCHING;
+            part->attempts++;
+            active++;
+        }
+        if (ret != EUCA_OK)
+            break;
+
+        if (active == 0) {             // the window is full or the parts left are backing off
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1;
+            pthread_mutex_lock(&(p->mutex));
+            if (!p->failed && (p->next_unpacked + BUNDLE_WINDOW) == window_end)
+                pthread_cond_timedwait(&(p->cond), &(p->mutex), &ts);
+            pthread_mutex_unlock(&(p->mutex));
+            continue;
+        }
+
+        curl_multi_perform(multi, &running);
+        while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&part);
+            httpcode = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpcode);
+            if ((msg->data.result == CURLE_OK) && (httpcode == 200L)) {
+                pthread_mutex_lock(&(p->mutex));
+                part->state = PART_FETCHED;
+                pthread_cond_broadcast(&(p->cond));
+                pthread_mutex_unlock(&(p->mutex));
+                fetched++;
+            } else if (((msg->data.result != CURLE_OK) || (httpcode == 408L)) && (part->attempts < total_attempts)) {
+                int backoff = FIRST_TIMEOUT << (part->attempts - 1);
+                LOGWARN("download attempt %d of %d of %s failed: %s (%d, HTTP %ld), retrying in %d sec\n", part->attempts, total_attempts, part->url,
+                        part->error_msg, msg->data.result, httpcode, ((backoff > MAX_TIMEOUT) ? MAX_TIMEOUT : backoff));
+                part->not_before = time(NULL) + ((backoff > MAX_TIMEOUT) ? MAX_TIMEOUT : backoff);
+                part->state = PART_PENDING;
+            } else {
+                LOGERROR("failed to download %s: %s (%d, HTTP %ld)\n", part->url, part->error_msg, msg->data.result, httpcode);
+                ret = EUCA_ERROR;
+            }
+            curl_multi_remove_handle(multi, part->curl);
+            curl_easy_cleanup(part->curl);
+            curl_slist_free_all(part->headers);
+            part->curl = NULL;
+            part->headers = NULL;
+            active--;
+        }
+
+        if ((now = time(NULL)) >= (last_update + PROGRESS_UPDATE_SEC)) {
+            LOGINFO("downloaded %d of %d parts (%lld MB of the image written) of %s\n", fetched, p->parts_size, p->image_wrote / MEGABYTE, url);
+            last_update = now;
+        }
+
+        if ((ret == EUCA_OK) && (running > 0)) {
+            FD_ZERO(&fd_read);
+            FD_ZERO(&fd_write);
+            FD_ZERO(&fd_exc);
+            max_fd = -1;
+            timeout_ms = -1;
+            curl_multi_fdset(multi, &fd_read, &fd_write, &fd_exc, &max_fd);
+            curl_multi_timeout(multi, &timeout_ms);
+            if ((timeout_ms < 0) || (timeout_ms > 1000))
+                timeout_ms = 1000;
+            tv.tv_sec = timeout_ms / 1000;
+            tv.tv_usec = (timeout_ms % 1000) * 1000;
+            if (max_fd == -1) {
+                usleep(100000);        // nothing to wait on yet, as with curl_multi_wait()
+            } else {
+                select(max_fd + 1, &fd_read, &fd_write, &fd_exc, &tv);
+            }
+        }
+    }
+
+    for (int i = 0; i < p->parts_size; i++) {
+        part = &(p->parts[i]);
+        if (part->curl) {
+            curl_multi_remove_handle(multi, part->curl);
+            curl_easy_cleanup(part->curl);
+            part->curl = NULL;
+        }
+        if (part->headers) {
+            curl_slist_free_all(part->headers);
+            part->headers = NULL;
+        }
+    }
+    curl_multi_cleanup(multi);
+    return (ret);
+}
+#endif /* CAN_GZIP */
+
+static int progress_function(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
+{
+    struct progress_data_t *progress_data = (struct progress_data_t *)clientp;
+    time_t now = time(NULL);
+
+    if (dltotal <= 0.0)                // can't do anything with that
+        return 0;
+
+    if ((progress_data->last_update + PROGRESS_UPDATE_SEC) <= now) {
+        double percent = (dlnow / dltotal) * 100.0;
+        LOGINFO("downloaded %.1f%% of %s\n", percent, progress_data->url);
+        progress_data->last_update = now;
+    }
+    return 0;
+}
+
+#ifdef _BENCHMARK
+//!
+//! CPU time used so far
+//!
+//! @param[in] who RUSAGE_SELF for all threads of this process or RUSAGE_CHILDREN for the helpers it waited for
+//!
+//! @return user and system time, in microseconds
+//!
+static long long bench_cpu_usec(int who)
+{
+    struct rusage ru = { {0} };
+
+    getrusage(who, &ru);
+    return (((long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec)) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+}
+
+//!
+//! qsort() comparator of latencies
+//!
+static int bench_compare(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Fills an image with megabytes that are either zeros or random bytes, which compress about
+//! as well as the mix of empty and used blocks of a root disk
+//!
+//! @param[out] buf the image
+//! @param[in]  len size of the image
+//! @param[in]  zero_percent share of the megabytes that are zeros
+//!
+static void bench_fill(unsigned char *buf, long long len, int zero_percent)
+{
+    unsigned long long x = 0x9E3779B97F4A7C15ULL;
+
+    for (long long off = 0; off < len; off += MEGABYTE) {
+        long long n = ((len - off) < MEGABYTE) ? (len - off) : MEGABYTE;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        if ((int)(x % 100) < zero_percent) {
+            bzero(buf + off, n);
+            continue;
+        }
+        for (long long i = 0; i < n; i++) {
+            if ((i % 8) == 0) {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+            }
+            buf[off + i] = (unsigned char)(x >> (8 * (i % 8)));
+        }
+    }
+}
+
+//!
+//! Compresses pieces of data, in order, into one gzip stream, as the object storage does
+//! for IsCompressed requests and the bundling tools do for the tar of an image
+//!
+//! @param[in]  pieces the data
+//! @param[in]  lens size of every piece
+//! @param[in]  count number of pieces
+//! @param[out] out_len size of the compressed stream
+//!
+//! @return the compressed stream, which the caller must free, or NULL on error
+//!
+static unsigned char *bench_gzip(const unsigned char **pieces, const long long *lens, int count, long long *out_len)
+{
+    int ret = Z_OK;
+    long long in_len = 0;
+    unsigned char *out = NULL;
+    z_stream strm = { 0 };
+
+    for (int i = 0; i < count; i++)
+        in_len += lens[i];
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, (16 + MAX_WBITS), 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return (NULL);
+    *out_len = deflateBound(&strm, in_len) + 1024;
+    if ((out = EUCA_ALLOC(*out_len, 1)) == NULL) {
+        deflateEnd(&strm);
+        return (NULL);
+    }
+
+    strm.next_out = out;
+    for (int i = 0; (i < count) && (ret == Z_OK); i++) {
+        for (long long off = 0; (off < lens[i]) && (ret == Z_OK); off += CHUNK) {
+            strm.next_in = (unsigned char *)pieces[i] + off;
+            strm.avail_in = ((lens[i] - off) < CHUNK) ? (lens[i] - off) : CHUNK;
+            strm.avail_out = (*out_len) - strm.total_out;
+            ret = deflate(&strm, Z_NO_FLUSH);
+        }
+    }
+    if (ret == Z_OK) {
+        strm.avail_out = (*out_len) - strm.total_out;
+        ret = deflate(&strm, Z_FINISH);
+    }
+    *out_len = strm.total_out;
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END)
+        EUCA_FREE(out);
+    return (out);
+}
+
+//!
+//! Fills in the tar header of a regular file, as bundle_untar() expects the image to start
+//!
+//! @param[out] header TAR_BLOCK bytes
+//! @param[in]  name of the file
+//! @param[in]  size of the file
+//!
+static void bench_tar_header(unsigned char *header, const char *name, long long size)
+{
+    unsigned int sum = 0;
+
+    bzero(header, TAR_BLOCK);
+    snprintf((char *)header, 100, "%s", name);
+    snprintf((char *)header + 100, 8, "%07o", 0644);
+    snprintf((char *)header + 108, 8, "%07o", 0);
+    snprintf((char *)header + 116, 8, "%07o", 0);
+    snprintf((char *)header + 124, 12, "%011llo", size);
+    snprintf((char *)header + 136, 12, "%011lo", (long)time(NULL));
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memset(header + 148, ' ', 8);      // the checksum counts its own field as spaces
+    for (int i = 0; i < TAR_BLOCK; i++)
+        sum += header[i];
+    snprintf((char *)header + 148, 8, "%06o", sum);
+}
+
+//!
+//! Creates a directory and its parents
+//!
+//! @param[in] path of the directory
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int bench_mkdirs(const char *path)
+{
+    char dir[EUCA_MAX_PATH] = "";
+
+    euca_strncpy(dir, path, sizeof(dir));
+    for (char *p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if ((mkdir(dir, 0700) != 0) && (errno != EEXIST))
+            return (EUCA_ERROR);
+        *p = '/';
+    }
+    if ((mkdir(dir, 0700) != 0) && (errno != EEXIST))
+        return (EUCA_ERROR);
+    return (EUCA_OK);
+}
+
+//!
+//! Sets up the node keys under a temporary $EUCALYPTUS, which sign the requests to the mock
+//! object storage and which bundles are encrypted for, and a euca_rootwrap that runs the
+//! helpers it is given, so that diskutil_dd() works without privileges
+//!
+//! @param[in]  euca_dir the temporary $EUCALYPTUS
+//! @param[out] pk_file buffer for the path of the private key
+//! @param[in]  pk_file_size
+//!
+//! @return the key, which the caller must free, or NULL on error
+//!
+static RSA *bench_make_keys(const char *euca_dir, char *pk_file, int pk_file_size)
+{
+    int ret = EUCA_ERROR;
+    char path[EUCA_MAX_PATH] = "";
+    const char *certs[] = { "node-cert.pem", "cloud-cert.pem" };
+    FILE *fp = NULL;
+    RSA *rsa = NULL;
+    BIGNUM *e = NULL;
+    X509 *cert = NULL;
+    EVP_PKEY *pkey = NULL;
+
+    snprintf(path, sizeof(path), EUCALYPTUS_KEYS_DIR, euca_dir);
+    if (bench_mkdirs(path) != EUCA_OK)
+        return (NULL);
+
+    if (((rsa = RSA_new()) == NULL) || ((e = BN_new()) == NULL) || !BN_set_word(e, RSA_F4) || !RSA_generate_key_ex(rsa, BENCH_RSA_BITS, e, NULL))
+        goto cleanup;
+    if (((pkey = EVP_PKEY_new()) == NULL) || !EVP_PKEY_set1_RSA(pkey, rsa) || ((cert = X509_new()) == NULL))
+        goto cleanup;
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_get_notBefore(cert), 0);
+    X509_gmtime_adj(X509_get_notAfter(cert), (60L * 60 * 24));
+    X509_set_pubkey(cert, pkey);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (const unsigned char *)"bench_objectstorage", -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+    if (!X509_sign(cert, pkey, EVP_sha256()))
+        goto cleanup;
+
+    snprintf(pk_file, pk_file_size, EUCALYPTUS_KEYS_DIR "/node-pk.pem", euca_dir);
+    if (((fp = fopen(pk_file, "w")) == NULL) || !PEM_write_RSAPrivateKey(fp, rsa, NULL, NULL, 0, NULL, NULL))
+        goto cleanup;
+    fclose(fp);
+    fp = NULL;
+    for (int i = 0; i < (sizeof(certs) / sizeof(certs[0])); i++) {
+        snprintf(path, sizeof(path), EUCALYPTUS_KEYS_DIR "/%s", euca_dir, certs[i]);
+        if (((fp = fopen(path, "w")) == NULL) || !PEM_write_X509(fp, cert))
+            goto cleanup;
+        fclose(fp);
+        fp = NULL;
+    }
+
+    snprintf(path, sizeof(path), EUCALYPTUS_LIBEXEC_DIR, euca_dir);
+    if (bench_mkdirs(path) != EUCA_OK)
+        goto cleanup;
+    snprintf(path, sizeof(path), EUCALYPTUS_ROOTWRAP, euca_dir);
+    if ((fp = fopen(path, "w")) == NULL)
+        goto cleanup;
+    fprintf(fp, "#!/bin/sh\nexec \"$@\"\n");
+    fclose(fp);
+    fp = NULL;
+    if (chmod(path, 0700) != 0)
+        goto cleanup;
+
+    setenv(EUCALYPTUS_ENV_VAR_NAME, euca_dir, 1);
+    ret = EUCA_OK;
+
+cleanup:
+    if (fp)
+        fclose(fp);
+    if (cert)
+        X509_free(cert);
+    if (pkey)
+        EVP_PKEY_free(pkey);
+    if (e)
+        BN_free(e);
+    if ((ret != EUCA_OK) && rsa) {
+        RSA_free(rsa);
+        rsa = NULL;
+    }
+    return (rsa);
+}
+
+//!
+//! Encrypts a key of a bundle for the manifest, as the hex of its hex encrypted with the
+//! public key of the cloud, which is what bundle_decrypt_key() undoes
+//!
+//! @param[in] rsa the key of the cloud
+//! @param[in] bytes the key of the bundle
+//! @param[in] len
+//!
+//! @return the value for the manifest, which the caller must free, or NULL on error
+//!
+static char *bench_encrypt_hex(RSA * rsa, const unsigned char *bytes, int len)
+{
+    int enc_len = 0;
+    char *hex = NULL;
+    char *out = NULL;
+    unsigned char *enc = NULL;
+
+    if (((hex = hexify((unsigned char *)bytes, len)) != NULL) && ((enc = EUCA_ALLOC(RSA_size(rsa), 1)) != NULL)
+        && ((enc_len = RSA_public_encrypt(strlen(hex), (unsigned char *)hex, enc, rsa, RSA_PKCS1_PADDING)) > 0)) {
+        out = hexify(enc, enc_len);
+    }
+    EUCA_FREE(hex);
+    EUCA_FREE(enc);
+    return (out);
+}
+
+//!
+//! Bundles an image the way the bundling tools do: tars it, compresses the tar, encrypts it
+//! with a new AES key and describes the parts, which are consecutive ranges of the encrypted
+//! bundle, in a manifest
+//!
+//! @param[in]  image
+//! @param[in]  size of the image
+//! @param[in]  rsa key of the cloud, which the AES key is encrypted for
+//! @param[in]  part_bytes size of the parts
+//! @param[out] bundle_len size of the encrypted bundle
+//! @param[out] manifest set to the manifest, which the caller must free
+//!
+//! @return the encrypted bundle, which the caller must free, or NULL on error
+//!
+static unsigned char *bench_make_bundle(const unsigned char *image, long long size, RSA * rsa, long long part_bytes, long long *bundle_len, char **manifest)
+{
+    int n = 0;
+    int parts = 0;
+    int len = 0;
+    long long gz_len = 0;
+    long long manifest_size = 0;
+    unsigned char header[TAR_BLOCK] = { 0 };
+    unsigned char trailer[3 * TAR_BLOCK] = { 0 };   // padding of the image up to a block and the two blocks that end the archive
+    unsigned char key[BENCH_AES_KEY_BYTES] = { 0 };
+    unsigned char iv[BENCH_AES_KEY_BYTES] = { 0 };
+    unsigned char *gz = NULL;
+    unsigned char *enc = NULL;
+    char *enc_key = NULL;
+    char *enc_iv = NULL;
+    EVP_CIPHER_CTX *cipher = NULL;
+    const unsigned char *pieces[3] = { header, image, trailer };
+    long long lens[3] = { TAR_BLOCK, size, (((TAR_BLOCK - (size % TAR_BLOCK)) % TAR_BLOCK) + 2 * TAR_BLOCK) };
+
+    *manifest = NULL;
+    bench_tar_header(header, "bench.img", size);
+    if ((gz = bench_gzip(pieces, lens, 3, &gz_len)) == NULL)
+        return (NULL);
+
+    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv)) || ((enc = EUCA_ALLOC(gz_len + EVP_MAX_BLOCK_LENGTH, 1)) == NULL)
+        || ((cipher = EVP_CIPHER_CTX_new()) == NULL) || !EVP_EncryptInit_ex(cipher, EVP_aes_128_cbc(), NULL, key, iv))
+        goto cleanup;
+    *bundle_len = 0;
+    for (long long off = 0; off < gz_len; off += CHUNK) {
+        if (!EVP_EncryptUpdate(cipher, enc + *bundle_len, &len, gz + off, (((gz_len - off) < CHUNK) ? (gz_len - off) : CHUNK)))
+            goto cleanup;
+        *bundle_len += len;
+    }
+    if (!EVP_EncryptFinal_ex(cipher, enc + *bundle_len, &len))
+        goto cleanup;
+    *bundle_len += len;
+
+    if (((enc_key = bench_encrypt_hex(rsa, key, sizeof(key))) == NULL) || ((enc_iv = bench_encrypt_hex(rsa, iv, sizeof(iv))) == NULL))
+        goto cleanup;
+    parts = (*bundle_len + part_bytes - 1) / part_bytes;
+    manifest_size = (2 * (strlen(enc_key) + strlen(enc_iv))) + (parts * 128LL) + 1024;
+    if ((*manifest = EUCA_ALLOC(manifest_size, 1)) == NULL)
+        goto cleanup;
+    n = snprintf(*manifest, manifest_size, "<?xml version=\"1.0\" ?><manifest><version>2007-10-10</version><bundler><name>bench_objectstorage</name></bundler>"
+                 "<machine_configuration><architecture>x86_64</architecture></machine_configuration><image><name>bench.img</name><type>machine</type>"
+                 "<size>%lld</size><bundled_size>%lld</bundled_size><ec2_encrypted_key algorithm=\"AES-128-CBC\">%s</ec2_encrypted_key>"
+                 "<user_encrypted_key algorithm=\"AES-128-CBC\">%s</user_encrypted_key><ec2_encrypted_iv>%s</ec2_encrypted_iv><user_encrypted_iv>%s</user_encrypted_iv>"
+                 "<parts count=\"%d\">", size, *bundle_len, enc_key, enc_key, enc_iv, enc_iv, parts);
+    for (int i = 0; i < parts; i++)
+        n += snprintf(*manifest + n, manifest_size - n, "<part index=\"%d\"><filename>bench.img.part.%d</filename><digest algorithm=\"SHA1\">0</digest></part>", i, i);
+    snprintf(*manifest + n, manifest_size - n, "</parts></image><signature>0</signature></manifest>");
+
+cleanup:
+    if (cipher)
+        EVP_CIPHER_CTX_free(cipher);
+    EUCA_FREE(gz);
+    EUCA_FREE(enc_key);
+    EUCA_FREE(enc_iv);
+    bzero(key, sizeof(key));
+    if (*manifest == NULL)
+        EUCA_FREE(enc);
+    return (enc);
+}
+
+//!
+//! Adds an object to those the mock object storage serves
+//!
+//! @param[in] path of the URL of the object
+//! @param[in] compressed set if it is the answer to requests with IsCompressed=true
+//! @param[in] data the content, which must outlive the server
+//! @param[in] len
+//!
+static void bench_add_object(const char *path, boolean compressed, const unsigned char *data, long long len)
+{
+    if (bench_objects_len < BENCH_MAX_OBJECTS) {
+        euca_strncpy(bench_objects[bench_objects_len].path, path, STRSIZE);
+        bench_objects[bench_objects_len].compressed = compressed;
+        bench_objects[bench_objects_len].data = data;
+        bench_objects[bench_objects_len].len = len;
+        bench_objects_len++;
+    }
+}
+
+//!
+//! Sends data on a connection of the mock server, no faster than its bandwidth
+//!
+//! @param[in] fd the connection
+//! @param[in] data
+//! @param[in] len
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the client went away
+//!
+static int bench_send(int fd, const unsigned char *data, long long len)
+{
+    ssize_t n = 0;
+    long long sent = 0;
+    long long ahead = 0;
+    long long started = mono_time_usec();
+
+    while (sent < len) {
+        if ((n = write(fd, data + sent, (((len - sent) < BENCH_SEND_BYTES) ? (len - sent) : BENCH_SEND_BYTES))) <= 0)
+            return (EUCA_ERROR);
+        sent += n;
+        if ((bench_bandwidth > 0) && ((ahead = ((sent * 1000000LL) / bench_bandwidth) - (mono_time_usec() - started)) > 0))
+            usleep(ahead);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Answers one request to the mock object storage and closes the connection. GET and HEAD
+//! are answered from the objects, with support for a single byte range, and PUT takes the
+//! content, no faster than the bandwidth, and drops it. The signature of requests is not
+//! checked, as what it costs is on the side of the object storage.
+//!
+//! @param[in] arg the connection
+//!
+//! @return Always NULL
+//!
+static void *bench_serve_request(void *arg)
+{
+    int fd = (int)((long)arg);
+    int len = 0;
+    ssize_t n = 0;
+    long long first = 0;
+    long long last = -1;
+    long long body = 0;
+    long long got = 0;
+    long long started = 0;
+    long long ahead = 0;
+    boolean compressed = FALSE;
+    char *end = NULL;
+    char *query = NULL;
+    char *range = NULL;
+    char *length = NULL;
+    char method[16] = "";
+    char target[STRSIZE] = "";
+    char hdr[512] = "";
+    char req[BENCH_REQUEST_BYTES] = "";
+    const bench_object *o = NULL;
+
+    while ((end = strstr(req, "\r\n\r\n")) == NULL) {
+        if ((len == (sizeof(req) - 1)) || ((n = read(fd, req + len, (sizeof(req) - 1 - len))) <= 0))
+            goto done;
+        len += n;
+        req[len] = '\0';
+    }
+    if (sscanf(req, "%15s %1023s", method, target) != 2)
+        goto done;
+    if (bench_latency_ms > 0)
+        usleep(bench_latency_ms * 1000);
+
+    if (!strcmp(method, "PUT")) {
+        if ((length = strstr(req, "\r\nContent-Length:")) != NULL)
+            body = strtoll(length + 17, NULL, 10);
+        if (strstr(req, "\r\nExpect: 100-continue") != NULL)
+            bench_send(fd, (const unsigned char *)"HTTP/1.1 100 Continue\r\n\r\n", 25);
+        body -= (len - ((end + 4) - req));  // what arrived with the headers
+        started = mono_time_usec();
+        while ((body > 0) && ((n = read(fd, req, ((body < sizeof(req)) ? body : sizeof(req)))) > 0)) {
+            body -= n;
+            got += n;
+            if ((bench_bandwidth > 0) && ((ahead = ((got * 1000000LL) / bench_bandwidth) - (mono_time_usec() - started)) > 0))
+                usleep(ahead);
+        }
+        snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", ((body > 0) ? "400 Bad Request" : "200 OK"));
+        bench_send(fd, (unsigned char *)hdr, strlen(hdr));
+        goto done;
+    }
+
+    if ((query = strchr(target, '?')) != NULL) {
+        *query++ = '\0';
+        compressed = (strstr(query, "IsCompressed=true") != NULL);
+    }
+    for (int i = 0; (i < bench_objects_len) && (o == NULL); i++) {
+        if (!strcmp(bench_objects[i].path, target) && (bench_objects[i].compressed == compressed))
+            o = &(bench_objects[i]);
+    }
+    if ((o == NULL) || (strcmp(method, "GET") && strcmp(method, "HEAD"))) {
+        snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", ((o == NULL) ? "404 Not Found" : "405 Method Not Allowed"));
+        bench_send(fd, (unsigned char *)hdr, strlen(hdr));
+        goto done;
+    }
+
+    if (((range = strstr(req, "\r\nRange: bytes=")) != NULL) && (sscanf(range + 15, "%lld-%lld", &first, &last) >= 1)) {
+        if ((last < 0) || (last >= o->len))
+            last = o->len - 1;
+        if ((first < 0) || (first > last)) {
+            snprintf(hdr, sizeof(hdr), "HTTP/1.1 416 Requested Range Not Satisfiable\r\nContent-Range: bytes */%lld\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", o->len);
+            bench_send(fd, (unsigned char *)hdr, strlen(hdr));
+            goto done;
+        }
+        snprintf(hdr, sizeof(hdr), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n",
+                 first, last, o->len, (last - first + 1));
+    } else {
+        first = 0;
+        last = o->len - 1;
+        snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n", o->len);
+    }
+    if ((bench_send(fd, (unsigned char *)hdr, strlen(hdr)) == EUCA_OK) && !strcmp(method, "GET"))
+        bench_send(fd, (o->data + first), (last - first + 1));
+
+done:
+    close(fd);
+    return (NULL);
+}
+
+//!
+//! Forks the mock object storage, listening on the loopback interface, which serves the
+//! objects added so far with a thread per connection. Since it is another process, the CPU
+//! time of the benchmark only counts the NC's side of the transfers.
+//!
+//! @param[out] port set to the port the server listens on
+//!
+//! @return the PID of the server or -1 on error
+//!
+static pid_t bench_server_start(int *port)
+{
+    int fd = -1;
+    int conn = -1;
+    pid_t pid = -1;
+    pthread_t thread = { 0 };
+    pthread_attr_t attr = { {0} };
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) || (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, 64) != 0)
+        || (getsockname(fd, (struct sockaddr *)&addr, &addr_len) != 0)) {
+        if (fd >= 0)
+            close(fd);
+        return (-1);
+    }
+    *port = ntohs(addr.sin_port);
+
+    fflush(NULL);
+    if ((pid = fork()) == 0) {
+        signal(SIGPIPE, SIG_IGN);
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        for (;;) {
+            if ((conn = accept(fd, NULL, NULL)) < 0)
+                continue;
+            if (pthread_create(&thread, &attr, bench_serve_request, (void *)((long)conn)) != 0)
+                close(conn);
+        }
+    }
+    close(fd);
+    return (pid);
+}
+
+//!
+//! Checks that a file holds the image
+//!
+//! @param[in] path of the file
+//! @param[in] image
+//! @param[in] size of the image
+//!
+//! @return EUCA_OK if it does or EUCA_ERROR otherwise
+//!
+static int bench_verify(const char *path, const unsigned char *image, long long size)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    ssize_t n = 0;
+    long long off = 0;
+    unsigned char buf[CHUNK];
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (EUCA_ERROR);
+    while ((ret == EUCA_OK) && ((n = read(fd, buf, sizeof(buf))) > 0)) {
+        if (((off + n) > size) || memcmp(buf, image + off, n))
+            ret = EUCA_ERROR;
+        off += n;
+    }
+    if (off != size)
+        ret = EUCA_ERROR;
+    close(fd);
+    return (ret);
+}
+
+//!
+//! Runs one stage once. Downloads go to 'dir'/image, which the write stage creates and which
+//! the later stages copy from or upload.
+//!
+//! @param[in] stage
+//! @param[in] base_url where the mock object storage serves the objects
+//! @param[in] dir for the files
+//! @param[in] pk_file key that the bundle is encrypted for
+//! @param[in] image what the files must end up holding
+//! @param[in] size of the image
+//! @param[in] streams ranges for http_get_ranges()
+//!
+//! @return EUCA_OK on success or the error of the stage
+//!
+static int bench_run(bench_stage stage, const char *base_url, const char *dir, const char *pk_file, const unsigned char *image, long long size, int streams)
+{
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    char url[STRSIZE] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char copy[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), "%s/image", dir);
+    snprintf(copy, sizeof(copy), "%s/image.copy", dir);
+    switch (stage) {
+    case BENCH_STAGE_WRITE:
+        if ((fd = open(path, (O_CREAT | O_WRONLY | O_TRUNC), 0600)) < 0)
+            return (EUCA_ERROR);
+        ret = EUCA_OK;
+        for (long long off = 0; (off < size) && (ret == EUCA_OK); off += MEGABYTE) {
+            long long n = ((size - off) < MEGABYTE) ? (size - off) : MEGABYTE;
+            if (write(fd, image + off, n) != n)
+                ret = EUCA_ERROR;
+        }
+        close(fd);
+        return (ret);
+    case BENCH_STAGE_HTTP_GET:
+        snprintf(url, sizeof(url), "%s/image.img", base_url);
+        return (http_get(url, path, NULL));
+    case BENCH_STAGE_HTTP_GET_RANGES:
+        snprintf(url, sizeof(url), "%s/image.img", base_url);
+        return (http_get_ranges(url, path, streams, NULL));
+    case BENCH_STAGE_OBJECT:
+        snprintf(url, sizeof(url), "%s/image.img", base_url);
+        return (objectstorage_object_by_url(url, path, FALSE));
+    case BENCH_STAGE_IMAGE_GZ:
+        snprintf(url, sizeof(url), "%s/image.manifest.xml", base_url);
+        return (objectstorage_image_by_manifest_url(url, path, TRUE));
+    case BENCH_STAGE_UNBUNDLE:
+        snprintf(url, sizeof(url), "%s/bundle.manifest.xml", base_url);
+        return (objectstorage_unbundle_by_manifest_url(url, pk_file, path, size));
+    case BENCH_STAGE_DD:
+        unlink(copy);
+        return (diskutil_dd(path, copy, MEGABYTE, ((size + MEGABYTE - 1) / MEGABYTE)));
+    case BENCH_STAGE_HTTP_PUT:
+        snprintf(url, sizeof(url), "%s/upload/image.img", base_url);
+        return (http_put(path, url, NULL, NULL));
+    default:
+        break;
+    }
+    return (ret);
+}
+
+//!
+//! Prints one result line. Every line starts with 'objectstorage_bench' and only holds key=value
+//! pairs, so results can be compared across runs with standard tools. For compressed downloads,
+//! the time the inflater spent on each part of its work shows which of the network, zlib and
+//! the disk the download was bound by.
+//!
+//! @param[in]     out stream to print to
+//! @param[in]     stage
+//! @param[in]     config key=value pairs describing the configuration
+//! @param[in]     size of the image
+//! @param[in,out] usec duration of every successful run, in microseconds (sorted by this function)
+//! @param[in]     runs number of entries in usec[]
+//! @param[in]     failed number of runs that failed
+//! @param[in]     cpu_usec CPU time of this process during the successful runs
+//! @param[in]     child_cpu_usec CPU time of the helpers during the successful runs
+//! @param[in]     inflated what the inflaters reported during the successful runs
+//!
+static void bench_report(FILE * out, bench_stage stage, const char *config, long long size, long long *usec, int runs, int failed, long long cpu_usec,
+                         long long child_cpu_usec, const bench_inflate_stats * inflated)
+{
+    long long total = 0;
+    double gb = 0.0;
+    char extra[256] = "";
+
+    for (int i = 0; i < runs; i++)
+        total += usec[i];
+    if (runs > 0)
+        qsort(usec, runs, sizeof(long long), bench_compare);
+    gb = ((double)size * runs) / (1024.0 * 1024.0 * 1024.0);
+
+#define _RATE(_bytes, _usec)                     (((_usec) > 0) ? (((double)(_bytes) / MEGABYTE) / ((_usec) / 1000000.0)) : 0.0)
+    if (stage == BENCH_STAGE_IMAGE_GZ) {
+        snprintf(extra, sizeof(extra), " compressed_mb=%.1f network_mb_per_sec=%.1f inflate_mb_per_sec=%.1f write_mb_per_sec=%.1f", ((runs > 0) ? ((double)inflated->in_bytes / runs / MEGABYTE) : 0.0),
+                 _RATE(inflated->in_bytes, (total - inflated->net_wait_usec)), _RATE(inflated->out_bytes, inflated->inflate_usec), _RATE(inflated->out_bytes, inflated->write_usec));
+    }
+    fprintf(out, "objectstorage_bench op=%s %s runs=%d failed=%d mb_per_sec=%.1f mean_ms=%.1f p50_ms=%.1f max_ms=%.1f cpu_ms_per_gb=%.0f child_cpu_ms_per_gb=%.0f%s\n",
+            bench_stage_names[stage], config, runs, failed, _RATE((size * runs), total), ((runs > 0) ? ((double)total / runs / 1000.0) : 0.0),
+            ((runs > 0) ? (usec[runs / 2] / 1000.0) : 0.0), ((runs > 0) ? (usec[runs - 1] / 1000.0) : 0.0), ((gb > 0) ? ((cpu_usec / 1000.0) / gb) : 0.0),
+            ((gb > 0) ? ((child_cpu_usec / 1000.0) / gb) : 0.0), extra);
+#undef _RATE
+    fflush(out);
+}
+
+//!
+//! Measures how fast the NC gets images in and out through http.c, objectstorage.c and
+//! diskutil_dd(), against a mock object storage on the loopback interface that can be held
+//! to a bandwidth and a latency. For every image size, it serves the image as it is, the
+//! image compressed, as for IsCompressed requests, and a bundle of the image, with its
+//! manifest and parts, and it runs every stage: a plain write of the image (the disk
+//! baseline), downloads with http_get(), http_get_ranges(), objectstorage_object_by_url(),
+//! objectstorage_image_by_manifest_url() with compression and
+//! objectstorage_unbundle_by_manifest_url(), a diskutil_dd() copy of the image and an
+//! upload with http_put(). Every download is checked against the image, outside of the
+//! timings.
+//!
+//! Usage: bench_objectstorage [-s size_mb,...] [-O ops] [-n runs] [-z zero_percent] [-b bandwidth_mbps]
+//! [-l latency_ms] [-p part_mb] [-r streams] [-d dir] [-o file]
+//!
+//! The files go to a temporary directory in 'dir', the current directory by default, and the
+//! node keys that sign the requests and open the bundle, to a temporary $EUCALYPTUS. A
+//! bandwidth of 0, the default, does not limit the server.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+static int do_benchmark(int argc, char **argv)
+{
+    int ch = 0;
+    int port = 0;
+    int errors = 0;
+    int failed = 0;
+    int ran = 0;
+    int parts = 0;
+    int sizes_len = 0;
+    int runs = BENCH_DEFAULT_RUNS;
+    int zero_percent = BENCH_DEFAULT_ZERO_PERCENT;
+    int part_mb = BENCH_DEFAULT_PART_MB;
+    int streams = BENCH_DEFAULT_STREAMS;
+    int sizes[BENCH_MAX_SIZES] = { 0 };
+    boolean do_stage[BENCH_STAGES] = { FALSE };
+    long long size = 0;
+    long long gz_len = 0;
+    long long bundle_len = 0;
+    long long started = 0;
+    long long cpu = 0;
+    long long child_cpu = 0;
+    long long *usec = NULL;
+    double bandwidth_mbps = 0.0;
+    char *item = NULL;
+    char *saveptr = NULL;
+    char *manifest = NULL;
+    char sizes_opt[256] = BENCH_DEFAULT_SIZES;
+    char ops_opt[256] = BENCH_DEFAULT_OPS;
+    char base_dir[EUCA_MAX_PATH] = ".";
+    char dir[EUCA_MAX_PATH] = "";
+    char euca_dir[EUCA_MAX_PATH] = "";
+    char pk_file[EUCA_MAX_PATH] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char base_url[STRSIZE] = "";
+    char config[512] = "";
+    unsigned char *image = NULL;
+    unsigned char *gz = NULL;
+    unsigned char *bundle = NULL;
+    const unsigned char *pieces[1] = { NULL };
+    pid_t server = -1;
+    RSA *rsa = NULL;
+    FILE *out = stdout;
+    bench_inflate_stats inflated = { 0 };
+
+    while ((ch = getopt(argc, argv, "s:O:n:z:b:l:p:r:d:o:")) != -1) {
+        switch (ch) {
+        case 's':
+            euca_strncpy(sizes_opt, optarg, sizeof(sizes_opt));
+            break;
+        case 'O':
+            euca_strncpy(ops_opt, optarg, sizeof(ops_opt));
+            break;
+        case 'n':
+            runs = atoi(optarg);
+            break;
+        case 'z':
+            zero_percent = atoi(optarg);
+            break;
+        case 'b':
+            bandwidth_mbps = atof(optarg);
+            break;
+        case 'l':
+            bench_latency_ms = atoi(optarg);
+            break;
+        case 'p':
+            part_mb = atoi(optarg);
+            break;
+        case 'r':
+            streams = atoi(optarg);
+            break;
+        case 'd':
+            euca_strncpy(base_dir, optarg, sizeof(base_dir));
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            printf("Usage: bench_objectstorage [-s size_mb,...] [-O ops] [-n runs] [-z zero_percent] [-b bandwidth_mbps] [-l latency_ms] [-p part_mb] [-r streams] [-d dir] [-o file]\n");
+            return (1);
+        }
+    }
+
+    snprintf(config, sizeof(config), "%s", sizes_opt);
+    for (item = strtok_r(config, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if ((sizes_len == BENCH_MAX_SIZES) || ((sizes[sizes_len++] = atoi(item)) < 1))
+            sizes_len = BENCH_MAX_SIZES + 1;
+    }
+    snprintf(config, sizeof(config), "%s", ops_opt);
+    for (item = strtok_r(config, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        int s = 0;
+        while ((s < BENCH_STAGES) && strcmp(item, bench_stage_names[s]))
+            s++;
+        if (s == BENCH_STAGES) {
+            printf("ERROR: unknown op '%s', the ops are %s\n", item, BENCH_DEFAULT_OPS);
+            return (1);
+        }
+        do_stage[s] = TRUE;
+    }
+    if ((sizes_len < 1) || (sizes_len > BENCH_MAX_SIZES) || (runs < 1) || (zero_percent < 0) || (zero_percent > 100) || (bandwidth_mbps < 0)
+        || (bench_latency_ms < 0) || (part_mb < 1) || (streams < 1)) {
+        printf("ERROR: need up to %d positive sizes, positive runs, part size and streams, a zero percentage of 0-100 and no negative bandwidth or latency\n",
+               BENCH_MAX_SIZES);
+        return (1);
+    }
+    bench_bandwidth = (long long)(bandwidth_mbps * MEGABYTE);
+
+    snprintf(dir, sizeof(dir), "%s/bench_objectstorage-XXXXXX", base_dir);
+    snprintf(euca_dir, sizeof(euca_dir), "/tmp/bench_objectstorage-euca-XXXXXX");
+    if ((mkdtemp(dir) == NULL) || (mkdtemp(euca_dir) == NULL) || ((rsa = bench_make_keys(euca_dir, pk_file, sizeof(pk_file))) == NULL)
+        || ((usec = EUCA_ZALLOC(runs, sizeof(long long))) == NULL)) {
+        printf("ERROR: failed to set up %s and the keys in %s\n", dir, euca_dir);
+        errors++;
+        goto cleanup;
+    }
+    curl_global_init(CURL_GLOBAL_SSL);
+    objectstorage_set_max_download_attempts(1);     // a retry would only hide a failure in the timings
+    diskutil_init(FALSE);              // only the helpers of diskutil_dd() are needed
+
+    for (int i = 0; (i < sizes_len) && (errors == 0); i++) {
+        size = sizes[i] * MEGABYTE;
+        bench_objects_len = 0;
+
+        // the content is prepared before the server forks, so that it serves it from shared memory
+        if ((image = EUCA_ALLOC(size, 1)) == NULL) {
+            printf("ERROR: failed to allocate a %d MB image\n", sizes[i]);
+            errors++;
+            break;
+        }
+        bench_fill(image, size, zero_percent);
+        pieces[0] = image;
+        if (((gz = bench_gzip(pieces, &size, 1, &gz_len)) == NULL)
+            || ((bundle = bench_make_bundle(image, size, rsa, (part_mb * MEGABYTE), &bundle_len, &manifest)) == NULL)) {
+            printf("ERROR: failed to compress and bundle the %d MB image\n", sizes[i]);
+            errors++;
+            break;
+        }
+        bench_add_object("/bench/image.img", FALSE, image, size);
+        bench_add_object("/bench/image.manifest.xml", TRUE, gz, gz_len);
+        bench_add_object("/bench/bundle.manifest.xml", FALSE, (unsigned char *)manifest, strlen(manifest));
+        parts = (bundle_len + (part_mb * MEGABYTE) - 1) / (part_mb * MEGABYTE);
+        for (int p = 0; p < parts; p++) {
+            snprintf(path, sizeof(path), "/bench/bench.img.part.%d", p);
+            bench_add_object(path, FALSE, (bundle + (p * part_mb * MEGABYTE)), MIN((part_mb * MEGABYTE), (bundle_len - (p * part_mb * MEGABYTE))));
+        }
+        if ((server = bench_server_start(&port)) < 0) {
+            printf("ERROR: failed to start the mock object storage\n");
+            errors++;
+            break;
+        }
+        snprintf(base_url, sizeof(base_url), "http://127.0.0.1:%d/bench", port);
+
+        for (int s = 0; s < BENCH_STAGES; s++) {
+            if (!do_stage[s] && ((s != BENCH_STAGE_WRITE) || !(do_stage[BENCH_STAGE_UNBUNDLE] || do_stage[BENCH_STAGE_DD] || do_stage[BENCH_STAGE_HTTP_PUT])))
+                continue;              // unbundling needs a file with room for the image, as a blob has, and the copy and the upload start from it
+
+            snprintf(config, sizeof(config), "size_mb=%d zero_percent=%d compressed_pct=%.0f parts=%d bandwidth_mbps=%.1f latency_ms=%d streams=%d", sizes[i],
+                     zero_percent, (100.0 * gz_len / size), parts, bandwidth_mbps, bench_latency_ms, streams);
+            ran = failed = 0;
+            cpu = child_cpu = 0;
+            bzero(&bench_inflated, sizeof(bench_inflated));
+            bzero(&inflated, sizeof(inflated));
+            for (int r = 0; r < runs; r++) {
+                snprintf(path, sizeof(path), "%s/image", dir);
+                bzero(&bench_inflated, sizeof(bench_inflated));
+
+                long long cpu_started = bench_cpu_usec(RUSAGE_SELF);
+                long long child_cpu_started = bench_cpu_usec(RUSAGE_CHILDREN);
+                started = mono_time_usec();
+                int ret = bench_run(s, base_url, dir, pk_file, image, size, streams);
+                long long elapsed = mono_time_usec() - started;
+
+                // what a download wrote must be the image, and the write stage restores it for the stages that follow
+                if ((ret == EUCA_OK) && (s != BENCH_STAGE_HTTP_PUT)) {
+                    if (s == BENCH_STAGE_DD)
+                        snprintf(path, sizeof(path), "%s/image.copy", dir);
+                    ret = bench_verify(path, image, size);
+                }
+                if (ret != EUCA_OK) {
+                    failed++;
+                    continue;
+                }
+                usec[ran++] = elapsed;
+                cpu += bench_cpu_usec(RUSAGE_SELF) - cpu_started;
+                child_cpu += bench_cpu_usec(RUSAGE_CHILDREN) - child_cpu_started;
+                inflated.in_bytes += bench_inflated.in_bytes;
+                inflated.out_bytes += bench_inflated.out_bytes;
+                inflated.net_wait_usec += bench_inflated.net_wait_usec;
+                inflated.inflate_usec += bench_inflated.inflate_usec;
+                inflated.inflate_wait_usec += bench_inflated.inflate_wait_usec;
+                inflated.write_usec += bench_inflated.write_usec;
+            }
+            if (do_stage[s])
+                bench_report(out, s, config, size, usec, ran, failed, cpu, child_cpu, &inflated);
+            errors += failed;
+            if ((s == BENCH_STAGE_WRITE) && (ran == 0))
+                break;                 // nothing to copy or upload
+        }
+
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        server = -1;
+        snprintf(path, sizeof(path), "%s/image", dir);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/image.copy", dir);
+        unlink(path);
+        EUCA_FREE(image);
+        EUCA_FREE(gz);
+        EUCA_FREE(bundle);
+        EUCA_FREE(manifest);
+    }
+
+cleanup:
+    if (server > 0) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    EUCA_FREE(image);
+    EUCA_FREE(gz);
+    EUCA_FREE(bundle);
+    EUCA_FREE(manifest);
+    EUCA_FREE(usec);
+    if (rsa)
+        RSA_free(rsa);
+    rmdir(dir);
+    if (euca_dir[0] != '\0') {
+        const char *files[] = { EUCALYPTUS_KEYS_DIR "/node-pk.pem", EUCALYPTUS_KEYS_DIR "/node-cert.pem", EUCALYPTUS_KEYS_DIR "/cloud-cert.pem", EUCALYPTUS_ROOTWRAP };
+        for (int i = 0; i < (sizeof(files) / sizeof(files[0])); i++) {
+            snprintf(path, sizeof(path), files[i], euca_dir);
+            unlink(path);
+            char *p = NULL;
+            while (((p = strrchr(path, '/')) != NULL) && (p > (path + strlen(euca_dir)))) {
+                *p = '\0';
+                rmdir(path);           // fails, harmlessly, while other files are left in it
+            }
+        }
+        rmdir(euca_dir);
+    }
+    if (out != stdout)
+        fclose(out);
+    return (errors);
+}
+
+//!
+//! Main entry point of the benchmark
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+int main(int argc, char **argv)
+{
+    logfile(NULL, EUCA_LOG_WARN, 4);   // progress lines of every download would go into the timings
+    exit(do_benchmark(argc, argv));
 }
+#endif /* _BENCHMARK */
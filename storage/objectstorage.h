@@ -119,7 +119,9 @@ int objectstorage_object_by_path(const char *path, const char *outfile, const in
 int objectstorage_image_by_manifest_url(const char *url, const char *outfile, const int do_compress);
 int objectstorage_image_by_manifest_path(const char *manifest_path, const char *outfile, const int do_compress);
 char *objectstorage_get_digest(const char *url);
+char *objectstorage_get_digest_etag(const char *url, const char *etag, char *new_etag, int new_etag_size, boolean * not_modified);
 int objectstorage_verify_digest(const char *url, const char *old_digest_path);
+int objectstorage_unbundle_by_manifest_url(const char *url, const char *pk_file, const char *outfile, long long size_bytes);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
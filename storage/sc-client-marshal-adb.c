@@ -258,10 +258,42 @@ scStub *scStubCreate(char *endpoint_uri, char *logfile, char *homedir)
 //!
 int scStubDestroy(scStub * pStub)
 {
-    EUCA_FREE(pStub->client_home);
-    EUCA_FREE(pStub->endpoint_uri);
-    EUCA_FREE(pStub->node_name);
-    EUCA_FREE(pStub);
+    if (pStub) {
+        axis2_stub_free(pStub->stub, pStub->env);
+        axutil_env_free(pStub->env);
+
+        EUCA_FREE(pStub->client_home);
+        EUCA_FREE(pStub->endpoint_uri);
+        EUCA_FREE(pStub->node_name);
+        EUCA_FREE(pStub);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Sets the transport timeout applied to every subsequent call made through an SC stub,
+//! so that a long-lived stub can be used without a watchdog process.
+//!
+//! @param[in] pStub a pointer to the storage controller (SC) stub structure
+//! @param[in] timeout the timeout in seconds (must be positive)
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int scStubSetTimeout(scStub * pStub, int timeout)
+{
+    axis2_svc_client_t *svc_client = NULL;
+    axis2_options_t *options = NULL;
+
+    if ((pStub == NULL) || (pStub->stub == NULL) || (timeout <= 0))
+        return (EUCA_ERROR);
+
+    if ((svc_client = axis2_stub_get_svc_client(pStub->stub, pStub->env)) == NULL)
+        return (EUCA_ERROR);
+
+    if ((options = (axis2_options_t *) axis2_svc_client_get_options(svc_client, pStub->env)) == NULL)
+        return (EUCA_ERROR);
+
+    axis2_options_set_timeout_in_milli_seconds(options, pStub->env, ((long)timeout) * 1000L);
     return (EUCA_OK);
 }
 
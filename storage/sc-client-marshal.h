@@ -126,6 +126,7 @@ typedef struct scStub_t {
 
 scStub *scStubCreate(char *endpoint_uri, char *logfile, char *homedir);
 int scStubDestroy(scStub * pStub);
+int scStubSetTimeout(scStub * pStub, int timeout);
 int scExportVolumeStub(scStub * pStub, char *correlationId, char *userId, char *volumeId, char *token, char *ip, char *iqn, char **connection_string);
 int scUnexportVolumeStub(scStub * pStub, char *correlationId, char *userId, char *volumeId, char *token, char *ip, char *iqn);
 
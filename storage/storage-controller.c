@@ -82,6 +82,7 @@
 #include <sys/wait.h>                  /* waitpid */
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include <eucalyptus.h>
@@ -142,12 +143,29 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Process-local pool of long-lived SC stubs shared by the threads of the process, see scStubPoolAcquire()
+static struct {
+    char scURL[512];                   //!< URL of the SC this stub talks to (empty if slot is free)
+    char policyFile[EUCA_MAX_PATH];    //!< WS-Security policy applied to the stub (empty if WS-Security is off)
+    scStub *stub;                      //!< the Axis2 stub, created once and reused across calls
+    pid_t owner;                       //!< process which created the stub, stubs never cross a fork()
+    int busy;                          //!< set while a thread is making a call through this stub
+    int calls;                         //!< number of calls made through this stub so far
+} scStubPool[SC_POOL_STUBS];
+
+static pthread_mutex_t sc_pool_mutex = PTHREAD_MUTEX_INITIALIZER; //!< protects the slots of scStubPool
+static int sc_pool_enabled = FALSE;    //!< set by scClientUsePool(), the fork()ing client is used otherwise
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int scStubPoolAcquire(char *scURL, int use_ws_sec, char *ws_sec_policy_file_path, int timeout);
+static void scStubPoolRelease(int slot, int failed);
+static int scClientCallPooled(scStub * scs, char *correlationId, char *userId, char *scOp, va_list al);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -160,11 +178,217 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//!
+//! Turns the pooling of SC stubs on or off for the calling process. With pooling, SC
+//! calls are made in-process through long-lived stubs, which keeps the connection to
+//! the SC and the WS-Security context of a stub across calls, instead of a child
+//! process setting both up for every call.
+//!
+//! @param[in] enable TRUE to make SC calls through pooled stubs, FALSE to fork() for each call
+//!
+void scClientUsePool(int enable)
+{
+    sc_pool_enabled = (enable) ? TRUE : FALSE;
+}
+
+//!
+//! Finds (or creates) an idle pooled SC stub for the given SC URL and WS-Security policy,
+//! marks it busy and arms it with the given call timeout. WS-Security is applied once,
+//! when the stub is created. A stub which was inherited from a parent process is never
+//! reused since the parent still owns the underlying connection.
+//!
+//! @param[in] scURL the URL of the storage controller
+//! @param[in] use_ws_sec an integer/boolean to indicate if WS-Sec should be used
+//! @param[in] ws_sec_policy_file_path a pointer to the string giving the SC client policy file
+//! @param[in] timeout the timeout, in seconds, for the upcoming call
+//!
+//! @return the pool slot holding a usable stub or -1 if none could be set up, in which
+//!         case the caller should fall back to the fork()ing client call
+//!
+static int scStubPoolAcquire(char *scURL, int use_ws_sec, char *ws_sec_policy_file_path, int timeout)
+{
+    int i = 0;
+    int slot = -1;
+    int idle = -1;
+    char *policy = NULL;
+    pid_t self = getpid();
+    scStub *evicted = NULL;
+
+    policy = (use_ws_sec) ? ws_sec_policy_file_path : "";
+    if (!scURL || (scURL[0] == '\0') || (strlen(scURL) >= sizeof(scStubPool[0].scURL)) || !policy || (strlen(policy) >= sizeof(scStubPool[0].policyFile)))
+        return (-1);
+
+    pthread_mutex_lock(&sc_pool_mutex);
+    {
+        for (i = 0; i < SC_POOL_STUBS; i++) {
+            if (scStubPool[i].busy)
+                continue;
+
+            if (scStubPool[i].stub && (scStubPool[i].owner != self)) {
+                // do not destroy it, the memory is only a copy of our parent's stub
+                scStubPool[i].stub = NULL;
+                scStubPool[i].scURL[0] = '\0';
+            }
+
+            if (scStubPool[i].stub == NULL) {
+                if (idle < 0)
+                    idle = i;
+            } else if (!strcmp(scStubPool[i].scURL, scURL) && !strcmp(scStubPool[i].policyFile, policy)) {
+                slot = i;
+                break;
+            }
+        }
+
+        if ((slot < 0) && (idle < 0)) {
+            // every idle stub talks to another SC (or under another policy), recycle one of them
+            for (i = 0; (i < SC_POOL_STUBS) && (idle < 0); i++) {
+                if (!scStubPool[i].busy && scStubPool[i].stub) {
+                    evicted = scStubPool[i].stub;
+                    scStubPool[i].stub = NULL;
+                    scStubPool[i].scURL[0] = '\0';
+                    idle = i;
+                }
+            }
+        }
+
+        if (slot < 0)
+            slot = idle;
+        if (slot >= 0)
+            scStubPool[slot].busy = TRUE;
+    }
+    pthread_mutex_unlock(&sc_pool_mutex);
+
+    if (evicted)
+        scStubDestroy(evicted);
+
+    if (slot < 0) {
+        LOGDEBUG("all %d pooled SC stubs are busy, not pooling scURL=%s\n", SC_POOL_STUBS, scURL);
+        return (-1);
+    }
+
+    if (scStubPool[slot].stub == NULL) {
+        if ((scStubPool[slot].stub = scStubCreate(scURL, NULL, NULL)) == NULL) {
+            LOGERROR("failed to create SC stub for scURL=%s\n", scURL);
+            scStubPoolRelease(slot, TRUE);
+            return (-1);
+        }
+
+        if (use_ws_sec) {
+            LOGTRACE("Configuring and Initializing WS-SEC for pooled SC Client\n");
+            if (InitWSSEC(scStubPool[slot].stub->env, scStubPool[slot].stub->stub, policy)) {
+                LOGERROR("failed to initialize WS-Security on SC stub for scURL=%s\n", scURL);
+                scStubPoolRelease(slot, TRUE);
+                return (-1);
+            }
+        }
+
+        euca_strncpy(scStubPool[slot].scURL, scURL, sizeof(scStubPool[slot].scURL));
+        euca_strncpy(scStubPool[slot].policyFile, policy, sizeof(scStubPool[slot].policyFile));
+        scStubPool[slot].owner = self;
+        scStubPool[slot].calls = 0;
+        LOGTRACE("created pooled SC stub slot=%d scURL=%s\n", slot, scURL);
+    }
+
+    if (scStubSetTimeout(scStubPool[slot].stub, timeout) != EUCA_OK) {
+        LOGWARN("failed to set a %d seconds timeout on SC stub for scURL=%s\n", timeout, scURL);
+        scStubPoolRelease(slot, TRUE);
+        return (-1);
+    }
+
+    scStubPool[slot].calls++;
+    return (slot);
+}
+
+//!
+//! Hands a stub back to the pool once a call has completed. A stub is recycled after
+//! a failed call (the connection state is unknown) or after SC_POOL_STUB_MAX_CALLS
+//! calls, which bounds the memory Axis2 accumulates over the lifetime of a stub.
+//!
+//! @param[in] slot the pool slot returned by scStubPoolAcquire()
+//! @param[in] failed set to TRUE if the call made through this stub failed
+//!
+static void scStubPoolRelease(int slot, int failed)
+{
+    scStub *recycled = NULL;
+
+    if ((slot < 0) || (slot >= SC_POOL_STUBS))
+        return;
+
+    pthread_mutex_lock(&sc_pool_mutex);
+    {
+        if (scStubPool[slot].stub && (failed || (scStubPool[slot].calls >= SC_POOL_STUB_MAX_CALLS))) {
+            LOGTRACE("recycling pooled SC stub slot=%d scURL=%s calls=%d failed=%d\n", slot, scStubPool[slot].scURL, scStubPool[slot].calls, failed);
+            recycled = scStubPool[slot].stub;
+            scStubPool[slot].stub = NULL;
+            scStubPool[slot].calls = 0;
+        }
+        if (scStubPool[slot].stub == NULL)
+            scStubPool[slot].scURL[0] = '\0';
+        scStubPool[slot].busy = FALSE;
+    }
+    pthread_mutex_unlock(&sc_pool_mutex);
+
+    if (recycled)
+        scStubDestroy(recycled);
+}
+
+//!
+//! Performs an SC operation in-process through a pooled stub. The arguments and the
+//! outputs are the same as for scClientCall() and outputs are only set when the call
+//! succeeds, exactly as the fork()ing path does.
+//!
+//! @param[in] scs a pointer to the pooled SC stub to use
+//! @param[in] correlationId a pointer to the correlationId string to use for the call to the SC
+//! @param[in] userId a pointer to the userId string to use for the call to the SC
+//! @param[in] scOp the operation to perform (i.e. "ExportVolume", "UnexportVolume",...)
+//! @param[in] al the operation specific arguments
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int scClientCallPooled(scStub * scs, char *correlationId, char *userId, char *scOp, va_list al)
+{
+    int rc = 0;
+    char *localCorrelationId = (correlationId) ? correlationId : "unset";
+    char *localUserId = (userId) ? userId : "eucalyptus";
+
+    LOGTRACE("\tscOps=%s pid=%d pooled client calling '%s'\n", scOp, getpid(), scOp);
+    if (!strcmp(scOp, "ExportVolume")) {
+        char *volumeId = va_arg(al, char *);
+        char *token = va_arg(al, char *);
+        char *ip = va_arg(al, char *);
+        char *iqn = va_arg(al, char *);
+        char **connectInfo = va_arg(al, char **);
+
+        if (connectInfo)
+            *connectInfo = NULL;
+
+        rc = scExportVolumeStub(scs, localCorrelationId, localUserId, volumeId, token, ip, iqn, connectInfo);
+        if (connectInfo && (rc || !(*connectInfo))) {
+            EUCA_FREE(*connectInfo);
+            rc = 1;
+        }
+    } else if (!strcmp(scOp, "UnexportVolume")) {
+        char *volumeId = va_arg(al, char *);
+        char *token = va_arg(al, char *);
+        char *ip = va_arg(al, char *);
+        char *iqn = va_arg(al, char *);
+
+        rc = scUnexportVolumeStub(scs, localCorrelationId, localUserId, volumeId, token, ip, iqn);
+    } else {
+        LOGWARN("\tscOps=%s operation '%s' not found\n", scOp, scOp);
+        rc = 1;
+    }
+
+    return ((rc) ? 1 : 0);
+}
+
 //!
 //! Make a call to the SC as specified with a string and a timeout.
 //!
 //! This implementation is heavily borrowed from the CC's ncClientCall.
-//! Uses fork/exec for client to preserve memory since Axis's destroy/free have issues
+//! When scClientUsePool() turned pooling on, the call is made in-process through a pooled
+//! stub. Otherwise, or when no pooled stub is available, uses fork/exec for client to
+//! preserve memory since Axis's destroy/free have issues
 //!
 //! @param[in] correlationId a pointer to the correlationId string to use for the call to the SC
 //! @param[in] userId a pointer to the userId string to use for the call to the SC
@@ -190,6 +414,7 @@ int scClientCall(char *correlationId, char *userId, int use_ws_sec, char *ws_sec
     int opFail = 0;
     int len = 0;
     int rbytes = 0;
+    int slot = -1;
     int filedes[2] = { 0 };
     char *localCorrelationId = NULL;
     char *localUserId = NULL;
@@ -201,6 +426,19 @@ int scClientCall(char *correlationId, char *userId, int use_ws_sec, char *ws_sec
     if (timeout <= 0)
         timeout = DEFAULT_SC_REQUEST_TIMEOUT;
 
+    if (sc_pool_enabled) {
+        if ((slot = scStubPoolAcquire(scURL, use_ws_sec, ws_sec_policy_file_path, timeout)) >= 0) {
+            va_start(al, scOp);
+            ret = scClientCallPooled(scStubPool[slot].stub, correlationId, userId, scOp, al);
+            va_end(al);
+
+            scStubPoolRelease(slot, ret);
+            LOGDEBUG("\tdone scOps=%s pooled clientrc=%d\n", scOp, ret);
+            return (ret);
+        }
+        LOGDEBUG("no pooled SC stub available for scURL=%s, forking for scOps=%s\n", scURL, scOp);
+    }
+
     if ((rc = pipe(filedes)) != 0) {
         LOGERROR("cannot create pipe scOps=%s\n", scOp);
         return (1);
@@ -84,6 +84,8 @@
 \*----------------------------------------------------------------------------*/
 
 #define DEFAULT_SC_REQUEST_TIMEOUT                  45  //!< 45  second sync call timeout
+#define SC_POOL_STUBS                               8   //!< most pooled SC stubs, i.e. SC calls made in-process at once
+#define SC_POOL_STUB_MAX_CALLS                      500 //!< calls made through a pooled SC stub before it is recycled
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -115,6 +117,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+void scClientUsePool(int enable);
 int scClientCall(char *correlationId, char *userId, int use_ws_sec, char *ws_sec_policy_file_path, int timeout, char *scURL, char *scOp, ...);
 
 /*----------------------------------------------------------------------------*\
@@ -89,6 +89,7 @@
 #include <dirent.h>                    /* open|read|close dir */
 #include <time.h>                      /* time() */
 #include <stdint.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 
 #include <openssl/sha.h>
@@ -112,12 +113,37 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define FLOPPY_MAX_SIZE                          (1024 * 2048)  //!< most bytes of the floppy template that are used
+#define FLOPPY_MAX_PLACEHOLDERS                  32     //!< most placeholders looked for in the floppy template
+#define FLOPPY_PLACEHOLDER_PREFIX                "MAGICEUCALYPTUS"  //!< what all the placeholders in the floppy template start with
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A value to put in place of a placeholder of the floppy template
+typedef struct floppyPatch_t {
+    const char *placeholder;           //!< the placeholder
+    const char *value;                 //!< what replaces it, padded with zeros up to len
+    int len;                           //!< how many bytes of the floppy the value overwrites
+} floppyPatch;
+
+//! The floppy template, read once and kept in memory along with where its placeholders are
+typedef struct floppyTemplate_t {
+    char path[EUCA_MAX_PATH];          //!< the file the template was read from
+    dev_t dev;                         //!< device of the file, to notice it was replaced
+    ino_t ino;                         //!< inode of the file, to notice it was replaced
+    time_t mtime;                      //!< modification time of the file, to notice it changed
+    off_t file_size;                   //!< size of the file, to notice it changed
+    mode_t mode;                       //!< permissions of the file, given to plain copies of it
+    char *image;                       //!< the first size bytes of the file
+    int size;                          //!< number of bytes in image
+    int offsets[FLOPPY_MAX_PLACEHOLDERS];   //!< where placeholders are in image, in increasing order
+    int num_offsets;                   //!< number of entries in offsets
+} floppyTemplate;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -150,12 +176,18 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static floppyTemplate floppy_template = { "" }; //!< the floppy template last used, guarded by floppy_template_mutex
+static pthread_mutex_t floppy_template_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int load_floppy_template(const char *path);
+static int write_floppy(const char *euca_home, const char *dest_path, const floppyPatch * patches, int num_patches, mode_t mode);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -344,6 +376,146 @@ int encryptWindowsPassword(char *pass, char *key, char **out, int *outsize)
     return (EUCA_OK);
 }
 
+//!
+//! Makes sure floppy_template holds the current contents of the template at path, reading it
+//! and finding its placeholders only when it was not read yet or the file changed since.
+//! Must be called with floppy_template_mutex held.
+//!
+//! @param[in] path path to the floppy template
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_IO_ERROR
+//!         and EUCA_MEMORY_ERROR.
+//!
+static int load_floppy_template(const char *path)
+{
+    int fd = -1;
+    int rbytes = 0;
+    char *image = NULL;
+    char *ptr = NULL;
+    struct stat st = { 0 };
+    floppyTemplate *t = &floppy_template;
+
+    if (stat(path, &st) < 0)
+        return (EUCA_IO_ERROR);
+
+    if (t->image && !strcmp(t->path, path) && (t->dev == st.st_dev) && (t->ino == st.st_ino) && (t->mtime == st.st_mtime) && (t->file_size == st.st_size))
+        return (EUCA_OK);
+
+    if ((image = EUCA_ALLOC(FLOPPY_MAX_SIZE, sizeof(char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        EUCA_FREE(image);
+        return (EUCA_IO_ERROR);
+    }
+
+    rbytes = read(fd, image, FLOPPY_MAX_SIZE);
+    close(fd);
+    if (rbytes < 0) {
+        EUCA_FREE(image);
+        return (EUCA_IO_ERROR);
+    }
+
+    EUCA_FREE(t->image);
+    bzero(t, sizeof(floppyTemplate));
+    euca_strncpy(t->path, path, sizeof(t->path));
+    t->dev = st.st_dev;
+    t->ino = st.st_ino;
+    t->mtime = st.st_mtime;
+    t->file_size = st.st_size;
+    t->mode = (st.st_mode & 07777);
+    t->image = image;
+    t->size = rbytes;
+
+    // remember where the placeholders are, so that making a floppy does not scan the whole template
+    for (ptr = image; (t->num_offsets < FLOPPY_MAX_PLACEHOLDERS)
+         && ((ptr = memmem(ptr, (rbytes - (ptr - image)), FLOPPY_PLACEHOLDER_PREFIX, strlen(FLOPPY_PLACEHOLDER_PREFIX))) != NULL); ptr++) {
+        t->offsets[t->num_offsets++] = (ptr - image);
+    }
+    LOGDEBUG("read floppy template %s (%d bytes, %d placeholders)\n", path, rbytes, t->num_offsets);
+    return (EUCA_OK);
+}
+
+//!
+//! Writes the floppy of an instance from the in-memory copy of the floppy template, with the
+//! placeholders of the template replaced by the given values, in a single write.
+//!
+//! @param[in] euca_home path to the Eucalyptus installation, where the template is
+//! @param[in] dest_path path to the floppy to write
+//! @param[in] patches the values to put in place of the placeholders (optional--can be NULL)
+//! @param[in] num_patches number of entries in patches
+//! @param[in] mode permissions of the floppy, 0 to use those of the template
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_IO_ERROR
+//!         and EUCA_MEMORY_ERROR.
+//!
+static int write_floppy(const char *euca_home, const char *dest_path, const floppyPatch * patches, int num_patches, mode_t mode)
+{
+    int i = 0;
+    int j = 0;
+    int fd = -1;
+    int rc = 0;
+    int len = 0;
+    int size = 0;
+    int offset = 0;
+    int num_offsets = 0;
+    int offsets[FLOPPY_MAX_PLACEHOLDERS] = { 0 };
+    char *buf = NULL;
+    char source_path[1024] = "";
+
+    snprintf(source_path, sizeof(source_path), EUCALYPTUS_HELPER_DIR "/floppy", euca_home);
+
+    pthread_mutex_lock(&floppy_template_mutex);
+    {
+        if ((rc = load_floppy_template(source_path)) == EUCA_OK) {
+            size = floppy_template.size;
+            if ((buf = EUCA_ALLOC((size + 1), sizeof(char))) == NULL) {
+                rc = EUCA_MEMORY_ERROR;
+            } else {
+                memcpy(buf, floppy_template.image, size);
+                num_offsets = floppy_template.num_offsets;
+                memcpy(offsets, floppy_template.offsets, sizeof(offsets));
+                if (mode == 0)
+                    mode = floppy_template.mode;
+            }
+        }
+    }
+    pthread_mutex_unlock(&floppy_template_mutex);
+
+    if (rc != EUCA_OK)
+        return (rc);
+
+    // values go in in the order of their placeholders, a value that runs over the next
+    // placeholder replaces it, as when the template was scanned a byte at a time
+    for (i = 0; i < num_offsets; i++) {
+        offset = offsets[i];
+        for (j = 0; j < num_patches; j++) {
+            len = strlen(patches[j].placeholder);
+            if (((offset + len) <= size) && !memcmp(buf + offset, patches[j].placeholder, len))
+                break;
+        }
+        if (j == num_patches)
+            continue;
+
+        len = (((offset + patches[j].len) <= size) ? patches[j].len : (size - offset));
+        bzero(buf + offset, len);
+        memcpy(buf + offset, patches[j].value, MIN(len, ((int)strlen(patches[j].value))));
+    }
+
+    if ((fd = open(dest_path, O_CREAT | O_TRUNC | O_WRONLY, mode)) < 0) {
+        EUCA_FREE(buf);
+        return (EUCA_IO_ERROR);
+    }
+
+    rc = write(fd, buf, size);
+    close(fd);
+    EUCA_FREE(buf);
+
+    if (rc != size)
+        return (EUCA_IO_ERROR);
+    return (EUCA_OK);
+}
+
 //!
 //!
 //!
@@ -358,34 +530,28 @@ int encryptWindowsPassword(char *pass, char *key, char **out, int *outsize)
 int makeWindowsFloppy(char *euca_home, char *rundir_path, char *keyName, char *instName)
 {
     int i = 0;
-    int fd = 0;
     int rc = 0;
-    int rbytes = 0;
-    int count = 0;
     int encsize = 0;
-    char *buf = NULL;
-    char *ptr = NULL;
-    char *tmp = NULL;
-    char *newpass = NULL;
     char dest_path[1024] = "";
-    char source_path[1024] = "";
     char password[16] = "";
     char *encpassword = NULL;
-    char *newInstName = NULL;
     char c[4] = "";
     char enckey[2048] = "";
     char keyNameHolder1[512] = "";
     char keyNameHolder2[512] = "";
     FILE *FH = NULL;
+    floppyPatch patches[] = {
+        {"MAGICEUCALYPTUSPASSWORDPLACEHOLDER", password, strlen("MAGICEUCALYPTUSPASSWORDPLACEHOLDER")},
+        {"MAGICEUCALYPTUSHOSTNAMEPLACEHOLDER", instName, strlen("MAGICEUCALYPTUSHOSTNAMEPLACEHOLDER")},
+    };
 
     if (!euca_home || !rundir_path || !strlen(euca_home) || !strlen(rundir_path)) {
         return (EUCA_ERROR);
     }
 
-    snprintf(source_path, 1024, EUCALYPTUS_HELPER_DIR "/floppy", euca_home);
     snprintf(dest_path, 1024, "%s/floppy", rundir_path);
     if (!keyName || !strlen(keyName) || !strlen(instName)) {
-        return (euca_execlp(NULL, "cp", "-a", source_path, dest_path, NULL));
+        return (write_floppy(euca_home, dest_path, NULL, 0, 0));
     }
 
     bzero(password, sizeof(char) * 16);
@@ -395,86 +561,16 @@ int makeWindowsFloppy(char *euca_home, char *rundir_path, char *keyName, char *i
             snprintf(c, 2, "%c", RANDALPHANUM());
         strcat(password, c);
     }
-    //  snprintf(source_path, 1024, "%s/usr/share/eucalyptus/floppy", euca_home);
-    //  snprintf(dest_path, 1024, "%s/floppy", rundir_path);
-
-    if ((buf = EUCA_ALLOC(1024 * 2048, sizeof(char))) == NULL) {
-        return (EUCA_MEMORY_ERROR);
-    }
-
-    if ((fd = open(source_path, O_RDONLY)) < 0) {
-        EUCA_FREE(buf);
-        return (EUCA_IO_ERROR);
-    }
 
-    rbytes = read(fd, buf, 1024 * 2048);
-    close(fd);
-    if (rbytes < 0) {
-        EUCA_FREE(buf);
-        return (EUCA_IO_ERROR);
+    // the password and host name go in place of their placeholders in the floppy, padded with zeros
+    if ((rc = write_floppy(euca_home, dest_path, patches, (sizeof(patches) / sizeof(floppyPatch)), 0700)) != EUCA_OK) {
+        return (rc);
     }
 
-    ptr = buf;
-    count = 0;
-    tmp = EUCA_ZALLOC(strlen("MAGICEUCALYPTUSPASSWORDPLACEHOLDER") + 1, sizeof(char));
-    newpass = EUCA_ZALLOC(strlen("MAGICEUCALYPTUSPASSWORDPLACEHOLDER") + 1, sizeof(char));
-    newInstName = EUCA_ZALLOC(strlen("MAGICEUCALYPTUSHOSTNAMEPLACEHOLDER") + 1, sizeof(char));
-
-    if (!tmp || !newpass || !newInstName) {
-        EUCA_FREE(tmp);
-        EUCA_FREE(newpass);
-        EUCA_FREE(newInstName);
-        EUCA_FREE(buf);
-        return (EUCA_MEMORY_ERROR);
-    }
-
-    snprintf(newpass, strlen(password) + 1, "%s", password);
-    snprintf(newInstName, strlen(instName) + 1, "%s", instName);
-    // Modify floopy disk file in memory by reading it in a loop with one byte increments.
-    // On each step partion of floppy is comparing to a MAGIC tokens that should present
-    // somewhere in the floppy disk. All tokens must be the same length!
-    while (count < rbytes) {
-        memcpy(tmp, ptr, strlen("MAGICEUCALYPTUSPASSWORDPLACEHOLDER"));
-        if (!strcmp(tmp, "MAGICEUCALYPTUSPASSWORDPLACEHOLDER")) {
-            memcpy(ptr, newpass, strlen("MAGICEUCALYPTUSPASSWORDPLACEHOLDER"));
-        }
-
-        if (!strcmp(tmp, "MAGICEUCALYPTUSHOSTNAMEPLACEHOLDER")) {
-            memcpy(ptr, newInstName, strlen("MAGICEUCALYPTUSHOSTNAMEPLACEHOLDER"));
-        }
-
-        ptr++;
-        count++;
-    }
-
-    if ((fd = open(dest_path, O_CREAT | O_TRUNC | O_RDWR, 0700)) < 0) {
-        EUCA_FREE(buf);
-        EUCA_FREE(tmp);
-        EUCA_FREE(newpass);
-        EUCA_FREE(newInstName);
-        return (EUCA_IO_ERROR);
-    }
-
-    rc = write(fd, buf, rbytes);
-    close(fd);
-
-    if (rc != rbytes) {
-        EUCA_FREE(buf);
-        EUCA_FREE(tmp);
-        EUCA_FREE(newpass);
-        EUCA_FREE(newInstName);
-        return (EUCA_IO_ERROR);
-    }
-
-    EUCA_FREE(buf);
-
     // encrypt password and write to console log for later retrieval
     sscanf(keyName, "%s %s %s", keyNameHolder1, enckey, keyNameHolder2);
     rc = encryptWindowsPassword(password, enckey, &encpassword, &encsize);
     if (rc) {
-        EUCA_FREE(tmp);
-        EUCA_FREE(newpass);
-        EUCA_FREE(newInstName);
         return (EUCA_ERROR);
     }
 
@@ -483,16 +579,10 @@ int makeWindowsFloppy(char *euca_home, char *rundir_path, char *keyName, char *i
         fprintf(FH, "<Password>\r\n%s\r\n</Password>\r\n", encpassword);
         fclose(FH);
         EUCA_FREE(encpassword);
-        EUCA_FREE(tmp);
-        EUCA_FREE(newpass);
-        EUCA_FREE(newInstName);
         return (EUCA_OK);
     }
 
     EUCA_FREE(encpassword);
-    EUCA_FREE(tmp);
-    EUCA_FREE(newpass);
-    EUCA_FREE(newInstName);
     return (EUCA_ERROR);
 }
 
@@ -558,16 +648,7 @@ static int decode_credential(char *credential, instance_creds * creds)
 //!
 int make_credential_floppy(char *euca_home, char *rundir_path, char *credential)
 {
-    int fd = 0;
-    int rc = 0;
-    int rbytes = 0;
-    int count = 0;
-    int ret = EUCA_ERROR;
     char dest_path[1024] = "";
-    char source_path[1024] = "";
-    char *ptr = NULL;
-    char *buf = NULL;
-    char *tmp = NULL;
     instance_creds creds;
 
     if (!euca_home || !rundir_path || !strlen(euca_home) || !strlen(rundir_path) || !credential || !strlen(credential)) {
@@ -578,74 +659,17 @@ int make_credential_floppy(char *euca_home, char *rundir_path, char *credential)
         return (EUCA_ERROR);
     }
 
-    snprintf(source_path, 1024, EUCALYPTUS_HELPER_DIR "/floppy", euca_home);
     snprintf(dest_path, 1024, "%s/floppy", rundir_path);
 
-    if ((buf = EUCA_ALLOC(1024 * 2048, sizeof(char))) == NULL) {
-        ret = EUCA_MEMORY_ERROR;
-        goto cleanup;
-    }
-
-    if ((fd = open(source_path, O_RDONLY)) < 0) {
-        ret = EUCA_IO_ERROR;
-        goto cleanup;
+    {
+        // each value overwrites as many bytes of the floppy as it is long, starting at its placeholder
+        floppyPatch patches[] = {
+            {"MAGICEUCALYPTUSINSTPUBKEYPLACEHOLDER", creds.instancePubkey, strlen(creds.instancePubkey)},
+            {"MAGICEUCALYPTUSAUTHPUBKEYPLACEHOLDER", creds.euareKey, strlen(creds.euareKey)},
+            {"MAGICEUCALYPTUSAUTHSIGNATPLACEHOLDER", creds.instanceToken, strlen(creds.instanceToken)},
+            {"MAGICEUCALYPTUSINSTPRIKEYPLACEHOLDER", creds.instancePk, strlen(creds.instancePk)},
+            {"MAGICEUCALYPTUSEUCAPUBKEYPLACEHOLDER", creds.eucaKey, strlen(creds.eucaKey)},
+        };
+        return (write_floppy(euca_home, dest_path, patches, (sizeof(patches) / sizeof(floppyPatch)), 0700));
     }
-
-    rbytes = read(fd, buf, 1024 * 2048);
-    close(fd);
-    if (rbytes < 0) {
-        ret = EUCA_IO_ERROR;
-        goto cleanup;
-    }
-
-    tmp = EUCA_ZALLOC(KEY_STRING_SIZE, sizeof(char));
-    if (!tmp) {
-        ret = EUCA_MEMORY_ERROR;
-        goto cleanup;
-    }
-
-    ptr = buf;
-    count = 0;
-    // Modify floopy disk file in memory by reading it in a loop with one byte increments.
-    // On each step partion of floppy is comparing to a MAGIC tokens that should present
-    // somewhere in the floppy disk. All tokens must be the same length!
-    while (count < rbytes) {
-        memcpy(tmp, ptr, strlen("MAGICEUCALYPTUSINSTPUBKEYPLACEHOLDER"));
-        if (!strcmp(tmp, "MAGICEUCALYPTUSINSTPUBKEYPLACEHOLDER")) {
-            memcpy(ptr, creds.instancePubkey, strlen(creds.instancePubkey));
-        } else if (!strcmp(tmp, "MAGICEUCALYPTUSAUTHPUBKEYPLACEHOLDER")) {
-            memcpy(ptr, creds.euareKey, strlen(creds.euareKey));
-        } else if (!strcmp(tmp, "MAGICEUCALYPTUSAUTHSIGNATPLACEHOLDER")) {
-            memcpy(ptr, creds.instanceToken, strlen(creds.instanceToken));
-        } else if (!strcmp(tmp, "MAGICEUCALYPTUSINSTPRIKEYPLACEHOLDER")) {
-            memcpy(ptr, creds.instancePk, strlen(creds.instancePk));
-        } else if (!strcmp(tmp, "MAGICEUCALYPTUSEUCAPUBKEYPLACEHOLDER")) {
-            memcpy(ptr, creds.eucaKey, strlen(creds.eucaKey));
-        }
-
-        ptr++;
-        count++;
-    }
-
-    if ((fd = open(dest_path, O_CREAT | O_TRUNC | O_RDWR, 0700)) < 0) {
-        ret = EUCA_IO_ERROR;
-        goto cleanup;
-    }
-
-    rc = write(fd, buf, rbytes);
-    close(fd);
-
-    if (rc != rbytes) {
-        ret = EUCA_IO_ERROR;
-        goto cleanup;
-    }
-
-    ret = EUCA_OK;
-
-cleanup:
-    if (buf != NULL)
-        EUCA_FREE(buf);
-    if (tmp != NULL)
-        EUCA_FREE(tmp);
-    return ret;
 }
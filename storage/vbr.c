@@ -89,6 +89,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -104,6 +105,8 @@
 #include "http.h"
 #include "ebs_utils.h"
 #include <ipc.h>
+#include <thread_pool.h>
+#include <euca_probe.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -120,6 +123,15 @@
 #define CREATE                                   1
 
 #define ARTIFACT_RETRY_SLEEP_USEC                500000LL
+#define ART_IMPLEMENT_WORKERS                    4  //!< worker threads of art_pool, shared by all trees being implemented, that implement branches on the side
+#define ART_FLIGHT_REPORT_USEC                   10000000LL //!< how often threads waiting on the creation of a cached artifact report its progress
+#define DIGEST_CACHE_TTL_SEC                     60 //!< default for how long a downloaded digest is used without revalidating it
+#define DIGEST_CACHE_ENTRIES                     64 //!< most digests kept in memory, after which the least recently validated one goes
+#define DIGEST_ETAG_SIZE                         256
+#define DOWNLOAD_STREAMS                         1  //!< default for how many ranges of a large image are downloaded from a URL at once
+#define PEER_CONNECT_TIMEOUT_SEC                 5  //!< how long to wait for a peer NC to accept a connection before trying the next one
+#define CHUNKS_SUFFIX                            ".chunks"  //!< manifest URLs ending in this name images uploaded as content-defined chunks
+#define CHUNKS_REUSE_BLOBS                       2  //!< most cached blobs whose chunks a chunked download tries to reuse
 
 #ifdef _UNIT_TEST
 #define BS_SIZE                                  20000000000 / 512
@@ -138,24 +150,104 @@
 #define EKI_SIZE                                 ( 1024LL )
 #endif /* _UNIT_TEST */
 
+#ifdef _BENCHMARK
+#define BENCH_DEFAULT_LAUNCHES                   32
+#define BENCH_DEFAULT_CONCURRENCY                4
+#define BENCH_DEFAULT_SIZES                      "8:6,32:3,128:1"   //!< image sizes in MB, each with its weight in the launch mix
+#define BENCH_DEFAULT_HIT_PERCENT                80 //!< launches of an image that an earlier launch already brought into the cache
+#define BENCH_MAX_SIZES                          16
+#define BENCH_MAX_THREADS                        64
+#define BENCH_TIMEOUT_USEC                       ( 1000000LL * 60 * 10 )
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! One dependency of an artifact, as implemented by art_implement_deps()
+typedef struct _art_branch {
+    artifact *a;                       //!< the dependency
+    blobstore *work_bs;
+    blobstore *cache_bs;
+    const char *work_prefix;
+    long long timeout_usec;
+    char instanceId[512];              //!< instance being serviced, for logging in the worker thread
+    thread_pool_future *future;        //!< set if the branch was submitted to art_pool
+    int ret;                           //!< result of art_implement_tree() for the branch
+} art_branch;
+
+//! Creation of a cached artifact by a thread of this process, which other threads that need
+//! the same artifact wait on rather than polling the lock of its blob
+typedef struct _art_flight {
+    char id[EUCA_MAX_PATH];            //!< ID of the blob being created in the cache
+    const blobstore *bs;               //!< the cache blobstore
+    char leader[32];                   //!< instance of the creating thread, for logging
+    char path[EUCA_MAX_PATH];          //!< file of the blob, once it exists, for reporting progress
+    long long size_bytes;
+    boolean is_done;
+    int ret;                           //!< outcome of the creation, once done
+    int refs;                          //!< the creating thread plus those waiting on it
+    pthread_cond_t cond;               //!< signaled, under art_flights_mutex, when the creation is done
+    struct _art_flight *next;
+} art_flight;
+
+//! Digest of an image (its manifest) as last downloaded by any thread of this process
+typedef struct _digest_entry {
+    char url[EUCA_MAX_PATH];           //!< where the digest is downloaded from
+    char *digest;                      //!< NULL until a download succeeds
+    char etag[DIGEST_ETAG_SIZE];       //!< ETag of the digest, "" if the server sent none
+    time_t validated;                  //!< when the digest was last downloaded or confirmed current
+    boolean is_fetching;               //!< set while a thread downloads or revalidates the digest
+    struct _digest_entry *next;
+} digest_entry;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#ifdef _BENCHMARK
+//! Stages of provisioning timed by the benchmark
+typedef enum _bench_stage {
+    BENCH_STAGE_DOWNLOAD = 0,          //!< creators that bring an image in: url, object storage, imaging and file
+    BENCH_STAGE_PARTITION,
+    BENCH_STAGE_DISK,                  //!< assembling and expanding disks
+    BENCH_STAGE_COPY,
+    BENCH_STAGE_IQN,
+    BENCH_STAGE_BLOB_LOCK,             //!< opening or creating a blob, which takes its lock
+    BENCH_STAGE_FLIGHT_WAIT,           //!< waiting on another thread creating the same cached artifact
+    BENCH_STAGE_RETRY_SLEEP,           //!< backing off before trying a contended artifact again
+    BENCH_STAGE_LAUNCH,                //!< the whole tree of an instance
+    BENCH_STAGES
+} bench_stage;
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#ifdef _BENCHMARK
+//! Latencies of one stage, across all the launches of the benchmark
+typedef struct _bench_samples {
+    long long *usec;                   //!< latency of every call, in microseconds
+    int len;                           //!< number of entries in usec[]
+    int size;                          //!< room in usec[]
+    int failed;                        //!< calls that failed or, for blob locks, that timed out
+} bench_samples;
+
+//! One launch of the benchmark's mix
+typedef struct _bench_launch {
+    char image[EUCA_MAX_PATH];         //!< file of the image, whose name is the image ID
+    int size_mb;
+    boolean is_hit;                    //!< set if an earlier launch uses the same image
+} bench_launch;
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -186,6 +278,24 @@ const char *euca_client_component_name = "nc";  //!< The client component name
 
 static __thread char current_instanceId[512] = "";  //!< instance ID that is being serviced, for logging only
 static sem *hostconfig_sem;
+static pthread_once_t art_pool_once = PTHREAD_ONCE_INIT;    //!< creates art_pool on first use
+static thread_pool *art_pool = NULL;   //!< workers implementing branches, or NULL if it could not be created
+static pthread_mutex_t art_flights_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< guards art_flights and the entries in it
+static art_flight *art_flights = NULL; //!< creations of cached artifacts in progress in this process
+static pthread_mutex_t digest_cache_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards the digest cache and the entries in it
+static pthread_cond_t digest_cache_cond = PTHREAD_COND_INITIALIZER; //!< signaled when a thread is done fetching a digest
+static digest_entry *digest_cache = NULL;   //!< digests downloaded by this process
+static int digest_cache_size = 0;
+static int digest_cache_ttl_sec = DIGEST_CACHE_TTL_SEC;
+static int download_streams = DOWNLOAD_STREAMS; //!< concurrent range requests used by url_creator for large images
+static char *image_peers_buf = NULL;   //!< copy of the list of peer NCs, which image_peers points into
+static char **image_peers = NULL;      //!< peer NCs that may have images this NC needs in their caches
+static int image_peers_count = 0;
+static int image_peer_port = 0;        //!< port of the web server on the peer NCs
+static char image_peer_dir[EUCA_MAX_PATH] = ""; //!< directory where this NC publishes its cached images to peers
+static boolean lazy_boot = FALSE;      //!< whether disk images from URLs are booted from overlays that fetch their blocks on demand
+static boolean compressed_cache = FALSE;    //!< whether whole-disk images are cached as compressed qcow2 files that instances boot from overlays of
+static blobstore *fast_cache_bs = NULL; //!< OPTIONAL faster cache tier, holding copies of the hottest blobs of the cache
 
 #ifdef _UNIT_TEST
 static blobstore *cache_bs = NULL;
@@ -200,6 +310,16 @@ static char vm_ids[TOTAL_VMS][PATH_MAX] = { {0} };
 static boolean do_fork = 0;
 #endif /* _UNIT_TEST */
 
+#ifdef _BENCHMARK
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards bench_samples_of[] and bench_next
+static bench_samples bench_samples_of[BENCH_STAGES] = { {0} };
+static const char *bench_stage_names[BENCH_STAGES] = { "download", "partition", "disk", "copy", "iqn", "blob_lock", "flight_wait", "retry_sleep", "launch" };
+static bench_launch *bench_launches = NULL;
+static int bench_launches_len = 0;
+static int bench_next = 0;             //!< next launch for a worker to take
+static const char *bench_sshkey = NULL;
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -221,6 +341,12 @@ static void update_vbr_with_backing_info(artifact * a);
 //! Creators return OK or an error code: either generic one (ERROR) or a code specific to a failed blobstore
 //! operation, which can be obtained using blobstore_get_error().
 static int url_creator(artifact * a);
+static int lazy_url_creator(artifact * a);
+static int compress_blob(artifact * a);
+static int compressed_url_creator(artifact * a);
+static int compressed_objectstorage_creator(artifact * a);
+static int overlay_creator(artifact * a);
+static artifact *art_alloc_compressed(const char *id, long long size_bytes, int (*creator) (artifact * a), virtualBootRecord * vbr);
 static int objectstorage_creator(artifact * a);
 static int imaging_creator(artifact * a);
 static int partition_creator(artifact * a);
@@ -233,15 +359,31 @@ static int iqn_creator(artifact * a);
 static int copy_creator(artifact * a);
 //! @}
 
+static int peer_fetch(artifact * a, const char *dest_path);
+static int chunks_fetch(artifact * a, const char *dest_path);
+static void peer_publish(artifact * a);
+static void peer_unpublish(artifact * a);
+
 static void art_print_tree(const char *prefix, artifact * a);
 static int art_gen_id(char *buf, unsigned int buf_size, const char *first, const char *sig);
+static int art_gen_content_key(char *buf, unsigned int buf_size, const char *manifest, long long size_bytes);
 static void convert_id(const char *src, char *dst, unsigned int size);
-static char *url_get_digest(const char *url, boolean * bail_flag);
+static char *url_get_digest(const char *url, const char *etag, char *new_etag, int new_etag_size, boolean * not_modified, boolean * bail_flag);
+static char *get_cached_digest(const char *url, boolean from_objectstorage, boolean * bail_flag);
 static artifact *art_alloc_vbr(virtualBootRecord * vbr, boolean do_make_work_copy, boolean is_migration_dest, boolean must_be_file, const char *sshkey, boolean * bail_flag);
 static artifact *art_alloc_disk(virtualBootRecord * vbr, artifact * prereqs[], int num_prereqs, artifact * parts[], int num_parts,
                                 artifact * emi_disk, boolean do_make_bootable, boolean do_make_work_copy, boolean is_migration_dest);
 static int find_or_create_blob(int flags, blobstore * bs, const char *id, long long size_bytes, const char *sig, blockblob ** bbp);
 static int find_or_create_artifact(int do_create, artifact * a, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, blockblob ** bbp);
+static art_flight *art_flight_join(const artifact * a, const blobstore * cache_bs, boolean may_lead, boolean * is_leader);
+static void art_flight_release(art_flight * f);
+static void art_flight_set_path(art_flight * f, const char *path);
+static void art_flight_finish(art_flight * f, int ret);
+static int art_flight_wait(art_flight * f, const artifact * a, long long timeout_usec);
+static boolean art_is_exclusive(const artifact * a);
+static void art_pool_init(void);
+static void *art_branch_thread(void *arg);
+static int art_implement_deps(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec, art_branch * branches);
 
 #ifdef _UNIT_TEST
 static blobstore *create_teststore(int size_blocks, const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation,
@@ -257,6 +399,18 @@ static int check_blob(blobstore * bs, const char *keyword, int expect);
 static void dummy_err_fn(const char *msg);
 #endif /* _UNIT_TEST */
 
+#ifdef _BENCHMARK
+static void bench_record(bench_stage stage, long long started, int ret);
+static int bench_creator(artifact * a);
+static int bench_compare(const void *a, const void *b);
+static void bench_report(FILE * out, const char *config, long long elapsed_usec);
+static int bench_parse_sizes(const char *list, int *sizes, int *weights, int max);
+static int bench_make_image(const char *path, int size_mb);
+static int bench_provision(const bench_launch * l, int n);
+static void *bench_worker(void *ptr);
+static int do_benchmark(const char *base, int argc, char **argv);
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -274,6 +428,20 @@ static void dummy_err_fn(const char *msg);
 #define GEN_ID()                                 gen_id(id, sizeof(id), "12345678")
 #endif /* _UNIT_TEST */
 
+//! @{
+//! @name Benchmark hooks
+//! Time the stages of art_implement_tree() in the benchmark build and vanish from all others
+#ifdef _BENCHMARK
+#define BENCH_START(_var)                        long long _var = mono_time_usec()
+#define BENCH_STOP(_stage, _var, _ret)           bench_record((_stage), (_var), (_ret))
+#define ART_CREATE(_a)                           bench_creator((_a))
+#else /* _BENCHMARK */
+#define BENCH_START(_var)
+#define BENCH_STOP(_stage, _var, _ret)
+#define ART_CREATE(_a)                           (_a)->creator((_a))
+#endif /* _BENCHMARK */
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
@@ -367,6 +535,129 @@ int vbr_update_hostconfig_scurl(char *new_sc_url)
     }
 }
 
+//!
+//! Sets how long a digest that was downloaded (or revalidated) is used as is. Afterwards,
+//! it is revalidated with If-None-Match, if the server gave it an ETag, or downloaded again.
+//!
+//! @param[in] ttl_sec 0 to revalidate digests every time they are needed
+//!
+//! @return the previous setting
+//!
+int vbr_set_digest_cache_ttl(int ttl_sec)
+{
+    pthread_mutex_lock(&digest_cache_mutex);
+    int old_ttl_sec = digest_cache_ttl_sec;
+    digest_cache_ttl_sec = ttl_sec;
+    pthread_mutex_unlock(&digest_cache_mutex);
+    LOGDEBUG("image digests are revalidated after %d sec\n", ttl_sec);
+    return (old_ttl_sec);
+}
+
+//!
+//! Sets how many byte ranges of a large image are downloaded from a URL at once. Servers that
+//! do not accept Range requests, and small images, are downloaded in one stream regardless.
+//!
+//! @param[in] streams 1 to download every image in a single stream
+//!
+//! @return the previous setting
+//!
+int vbr_set_download_streams(int streams)
+{
+    int old_streams = download_streams;
+    download_streams = streams;
+    LOGDEBUG("large images are downloaded in up to %d streams\n", streams);
+    return (old_streams);
+}
+
+//!
+//! Sets whether instances of whole-disk images from URLs boot right away from a qcow2 overlay
+//! backed by the URL, which the hypervisor reads from on demand, instead of after the image is
+//! downloaded into the cache. Only meaningful on KVM, with a QEMU that has the curl block driver.
+//!
+//! @param[in] enable
+//!
+//! @return the previous setting
+//!
+boolean vbr_set_lazy_boot(boolean enable)
+{
+    boolean old_enable = lazy_boot;
+    lazy_boot = enable;
+    LOGDEBUG("disk images from URLs %s booted lazily\n", (enable ? "are" : "are not"));
+    return (old_enable);
+}
+
+//!
+//! Sets whether whole-disk images are kept in the cache compressed, as read-only qcow2 files,
+//! with each instance booting from a qcow2 overlay of its own that QEMU decompresses the image
+//! into as the guest reads it, instead of from a raw copy. Only meaningful on KVM.
+//!
+//! @param[in] enable
+//!
+//! @return the previous setting
+//!
+boolean vbr_set_compressed_cache(boolean enable)
+{
+    boolean old_enable = compressed_cache;
+    compressed_cache = enable;
+    LOGDEBUG("whole-disk images %s cached compressed\n", (enable ? "are" : "are not"));
+    return (old_enable);
+}
+
+//!
+//! Sets the fast tier of the cache: a blobstore on faster storage that holds copies of the most
+//! launched blobs of the cache. Cached artifacts that are looked up are taken from the fast tier
+//! when it has them, so that instances are cloned from there; artifacts are still created, and
+//! downloaded, into the cache passed to art_implement_tree(), from which the backing store copies
+//! them into the fast tier.
+//!
+//! @param[in] bs the fast tier or NULL for none
+//!
+void vbr_set_fast_cache(blobstore * bs)
+{
+    fast_cache_bs = bs;
+    LOGDEBUG("cached artifacts %s looked up in a fast tier first\n", ((bs != NULL) ? "are" : "are not"));
+}
+
+//!
+//! Sets up the sharing of cached images with other NCs. Images downloaded from object storage
+//! or a URL get published in publish_dir, under their content keys, where the web server of
+//! the NC serves them to the peers. Before downloading an image, the NC asks the peers for it.
+//!
+//! @param[in] peers space-separated list of peer NCs, typically all the NCs of the cluster
+//! @param[in] port port of the web server on the peer NCs
+//! @param[in] publish_dir directory served to the peers by the web server of this NC
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+//! @pre Must be called once, before any images are downloaded
+//!
+int vbr_set_image_peers(const char *peers, int port, const char *publish_dir)
+{
+    char *peer = NULL;
+    char *saveptr = NULL;
+
+    if ((peers == NULL) || (publish_dir == NULL) || (port < 1))
+        return (EUCA_ERROR);
+
+    if ((mkdir(publish_dir, 0755) == -1) && (errno != EEXIST)) {
+        LOGERROR("failed to create directory %s for images shared with peers: %s\n", publish_dir, strerror(errno));
+        return (EUCA_ERROR);
+    }
+
+    if (((image_peers_buf = strdup(peers)) == NULL) || ((image_peers = EUCA_ZALLOC((strlen(peers) / 2) + 1, sizeof(char *))) == NULL)) {
+        EUCA_FREE(image_peers_buf);
+        return (EUCA_ERROR);
+    }
+    for (peer = strtok_r(image_peers_buf, " \t,", &saveptr); peer; peer = strtok_r(NULL, " \t,", &saveptr)) {
+        if (strcmp(peer, localhost_config.ip))  // no point in asking ourselves
+            image_peers[image_peers_count++] = peer;
+    }
+    image_peer_port = port;
+    euca_strncpy(image_peer_dir, publish_dir, sizeof(image_peer_dir));
+    LOGINFO("sharing cached images with %d peer(s) through %s\n", image_peers_count, image_peer_dir);
+    return (EUCA_OK);
+}
+
 //!
 //! Picks a service URI and prepends it to resourceLocation in VBR
 //!
@@ -1022,8 +1313,11 @@ static int url_creator(artifact * a)
         LOGINFO("[%s] skipping download of %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_OK);
     }
+    peer_unpublish(a);
+    if (peer_fetch(a, dest_path) == EUCA_OK)
+        return (EUCA_OK);
     LOGINFO("[%s] downloading %s\n", a->instanceId, vbr->preparedResourceLocation);
-    if (http_get(vbr->preparedResourceLocation, dest_path, NULL) != EUCA_OK) {
+    if (http_get_ranges(vbr->preparedResourceLocation, dest_path, download_streams, NULL) != EUCA_OK) {
         LOGERROR("[%s] failed to download component %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_ERROR);
     }
@@ -1031,6 +1325,298 @@ static int url_creator(artifact * a)
     return (EUCA_OK);
 }
 
+//!
+//! Creates a per-instance artifact of a disk image at a URL without downloading it: a qcow2
+//! overlay whose backing file is the URL, so that the hypervisor fetches the blocks that the
+//! guest reads, copying them into the overlay, and the rest gets pulled in once it runs
+//!
+//! @param[in] a pointer to artifact with all necesary information
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int lazy_url_creator(artifact * a)
+{
+    int j = 0;
+    char size[32] = "";
+    char options[VERY_BIG_CHAR_BUFFER_SIZE * 2 + 64] = "backing_fmt=raw,backing_file=";
+    assert(a->bb);
+    assert(a->vbr);
+    virtualBootRecord *vbr = a->vbr;
+    const char *dest_path = blockblob_get_file(a->bb);
+
+    assert(vbr->preparedResourceLocation);
+    // commas separate qemu-img options, so the ones in the URL must be doubled
+    j = strlen(options);
+    for (const char *c = vbr->preparedResourceLocation; *c && (j < (sizeof(options) - 2)); c++) {
+        if (*c == ',')
+            options[j++] = ',';
+        options[j++] = *c;
+    }
+    options[j] = '\0';
+    snprintf(size, sizeof(size), "%lld", vbr->sizeBytes);
+
+    LOGINFO("[%s] creating an overlay that fetches %s on demand\n", a->instanceId, vbr->preparedResourceLocation);
+    if (euca_execlp(NULL, "qemu-img", "create", "-q", "-f", "qcow2", "-o", options, dest_path, size, NULL) != EUCA_OK) {
+        LOGERROR("[%s] failed to create an overlay for %s\n", a->instanceId, vbr->preparedResourceLocation);
+        return (EUCA_ERROR);
+    }
+    euca_strncpy(vbr->backingFormat, "qcow2", sizeof(vbr->backingFormat));
+    return (EUCA_OK);
+}
+
+//!
+//! Compresses the raw disk image that was just written into the blob of an artifact, turning
+//! it into a compressed qcow2 image. The blob file keeps its inode and its size, the tail past
+//! the qcow2 image being a hole, so that the blobstore finds it as it was created and counts it
+//! by the blocks it takes up.
+//!
+//! @param[in] a pointer to artifact whose blob holds the raw image
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int compress_blob(artifact * a)
+{
+    int ret = EUCA_ERROR;
+    char tmp_path[EUCA_MAX_PATH] = "";
+    struct stat sb = { 0 };
+    const char *dest_path = blockblob_get_file(a->bb);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.qcow2", dest_path);
+    LOGINFO("[%s] compressing cached image %s\n", a->instanceId, a->bb->id);
+    // the format of the input is given, so that qemu-img does not probe a guest's image
+    if (euca_execlp(NULL, "qemu-img", "convert", "-q", "-c", "-f", "raw", "-O", "qcow2", dest_path, tmp_path, NULL) != EUCA_OK) {
+        LOGERROR("[%s] failed to compress %s\n", a->instanceId, dest_path);
+        goto out;
+    }
+    if (stat(tmp_path, &sb) != 0)
+        goto out;
+    if (sb.st_size > a->bb->size_bytes) {
+        LOGERROR("[%s] compressed image (%lld bytes) is larger than the raw one (%lld bytes)\n", a->instanceId, (long long)sb.st_size, a->bb->size_bytes);
+        goto out;
+    }
+    if ((copy_file(tmp_path, dest_path) != EUCA_OK) || (truncate(dest_path, a->bb->size_bytes) != 0)) {
+        LOGERROR("[%s] failed to replace %s with its compressed image\n", a->instanceId, dest_path);
+        goto out;
+    }
+    LOGDEBUG("[%s] compressed %s from %lld to %lld bytes\n", a->instanceId, a->bb->id, a->bb->size_bytes, (long long)sb.st_size);
+    ret = EUCA_OK;
+
+out:
+    unlink(tmp_path);
+    return (ret);
+}
+
+//!
+//! Creates a compressed cached artifact by downloading a disk image from a URL
+//!
+//! @param[in] a pointer to artifact with all necesary information
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int compressed_url_creator(artifact * a)
+{
+    int ret = EUCA_OK;
+
+    if (((ret = url_creator(a)) != EUCA_OK) || a->do_not_download)
+        return (ret);
+    return (compress_blob(a));
+}
+
+//!
+//! Creates a compressed cached artifact by downloading a disk image from objectstorage
+//!
+//! @param[in] a pointer to artifact with all necesary information
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int compressed_objectstorage_creator(artifact * a)
+{
+    int ret = EUCA_OK;
+
+    if (((ret = objectstorage_creator(a)) != EUCA_OK) || a->do_not_download)
+        return (ret);
+    return (compress_blob(a));
+}
+
+//!
+//! Creates a per-instance artifact of a compressed cached image: a qcow2 overlay backed by the
+//! cached blob, into which the guest's writes go. The cached blob is recorded as its backing, so
+//! that it stays in the cache for as long as the overlay exists.
+//!
+//! @param[in] a pointer to artifact with all necesary information
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int overlay_creator(artifact * a)
+{
+    int j = 0;
+    char size[32] = "";
+    char options[EUCA_MAX_PATH * 2 + 64] = "backing_fmt=qcow2,backing_file=";
+    assert(a->bb);
+    assert(a->vbr);
+    assert(a->deps[0]);
+    artifact *dep = a->deps[0];
+    virtualBootRecord *vbr = a->vbr;
+    const char *dest_path = blockblob_get_file(a->bb);
+
+    if (dep->bb == NULL) {
+        LOGERROR("[%s] no cached image to create an overlay of\n", a->instanceId);
+        return (EUCA_ERROR);
+    }
+    const char *backing_path = blockblob_get_file(dep->bb);
+
+    // commas separate qemu-img options, so the ones in the path must be doubled
+    j = strlen(options);
+    for (const char *c = backing_path; *c && (j < (sizeof(options) - 2)); c++) {
+        if (*c == ',')
+            options[j++] = ',';
+        options[j++] = *c;
+    }
+    options[j] = '\0';
+    snprintf(size, sizeof(size), "%lld", a->size_bytes);
+
+    LOGINFO("[%s] creating an overlay of compressed blob %s\n", a->instanceId, dep->bb->id);
+    if (blockblob_add_backing(a->bb, dep->bb) == -1) {
+        LOGERROR("[%s] failed to record blob %s as the backing of %s: %s\n", a->instanceId, dep->bb->id, a->bb->id, blobstore_get_last_msg());
+        return (EUCA_ERROR);
+    }
+    if (euca_execlp(NULL, "qemu-img", "create", "-q", "-f", "qcow2", "-o", options, dest_path, size, NULL) != EUCA_OK) {
+        LOGERROR("[%s] failed to create an overlay of %s\n", a->instanceId, backing_path);
+        return (EUCA_ERROR);
+    }
+    // the hypervisor reads the backing file, too
+    if (diskutil_ch(backing_path, NULL, NULL, 0664) != EUCA_OK) {
+        LOGWARN("[%s] failed to change permissions on '%s'\n", a->instanceId, backing_path);
+    }
+    euca_strncpy(vbr->backingFormat, "qcow2", sizeof(vbr->backingFormat));
+    return (EUCA_OK);
+}
+
+//!
+//! Tries to download an image from the caches of peer NCs, starting with a random one so that
+//! the load of a launch on many NCs spreads over all the peers that have the image
+//!
+//! @param[in] a artifact with a content key
+//! @param[in] dest_path file to download into
+//!
+//! @return EUCA_OK if a peer had the whole image or EUCA_ERROR otherwise
+//!
+static int peer_fetch(artifact * a, const char *dest_path)
+{
+    int first = 0;
+    char url[EUCA_MAX_PATH] = "";
+    struct stat sb = { 0 };
+
+    if ((image_peers_count < 1) || (a->content_key[0] == '\0'))
+        return (EUCA_ERROR);
+
+    first = (int)(random() % image_peers_count);
+    for (int i = 0; i < image_peers_count; i++) {
+        const char *peer = image_peers[(first + i) % image_peers_count];
+        snprintf(url, sizeof(url), "http://%s:%d/%s", peer, image_peer_port, a->content_key);
+        // one try per peer, since most of them will not have the image
+        if ((http_get_timeout(url, dest_path, 1, 1, PEER_CONNECT_TIMEOUT_SEC, 0, NULL) == EUCA_OK) && (stat(dest_path, &sb) == 0)
+            && (sb.st_size >= a->vbr->sizeBytes)) {
+            LOGINFO("[%s] downloaded %s from peer %s\n", a->instanceId, a->vbr->preparedResourceLocation, peer);
+            return (EUCA_OK);
+        }
+        LOGDEBUG("[%s] peer %s does not have %s\n", a->instanceId, peer, a->content_key);
+    }
+    return (EUCA_ERROR);
+}
+
+//!
+//! Lets peer NCs download a cached image that was just created or found, by linking the
+//! file of its blob into the directory served to them
+//!
+//! @param[in] a artifact with a content key and an open blob in the cache
+//!
+static void peer_publish(artifact * a)
+{
+    char link_path[EUCA_MAX_PATH] = "";
+    const char *blocks_path = NULL;
+
+    if ((image_peer_dir[0] == '\0') || (a->content_key[0] == '\0') || !a->is_in_cache || (a->bb == NULL))
+        return;
+    if ((blocks_path = blockblob_get_file(a->bb)) == NULL)
+        return;
+
+    snprintf(link_path, sizeof(link_path), "%s/%s", image_peer_dir, a->content_key);
+    unlink(link_path);
+    if (symlink(blocks_path, link_path) == -1)
+        LOGWARN("[%s] failed to share cached artifact %s with peers: %s\n", a->instanceId, a->id, strerror(errno));
+}
+
+//!
+//! Withdraws an image from the peers before its blob is (re)created, since the blob of an image
+//! that was purged from the cache may be recreated in the same place as the published one
+//!
+//! @param[in] a artifact with a content key
+//!
+static void peer_unpublish(artifact * a)
+{
+    char link_path[EUCA_MAX_PATH] = "";
+
+    if ((image_peer_dir[0] == '\0') || (a->content_key[0] == '\0'))
+        return;
+    snprintf(link_path, sizeof(link_path), "%s/%s", image_peer_dir, a->content_key);
+    unlink(link_path);
+}
+
+//!
+//! Downloads an image uploaded as a chunk manifest, copying the chunks it shares with
+//! the most recently used blobs of the same size in the blobstore of the artifact, which
+//! are usually earlier versions of the same image, instead of downloading them again
+//!
+//! @param[in] a artifact whose manifest URL ends in CHUNKS_SUFFIX
+//! @param[in] dest_path file to download into
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int chunks_fetch(artifact * a, const char *dest_path)
+{
+    int ret = EUCA_OK;
+    int nreuse = 0;
+    const char *reuse_paths[CHUNKS_REUSE_BLOBS] = { NULL };
+    blockblob *reuse[CHUNKS_REUSE_BLOBS] = { NULL };
+    blockblob_meta *bm = NULL;
+    blockblob_meta *next = NULL;
+    blockblob_meta *best = NULL;
+    blockblob_meta *matches = NULL;
+
+    if (blobstore_search(a->bb->store, ".*", &matches) > 0) {
+        while (nreuse < CHUNKS_REUSE_BLOBS) {
+            best = NULL;
+            for (bm = matches; bm; bm = bm->next) {
+                if ((bm->size_bytes == a->bb->size_bytes) && strcmp(bm->id, a->bb->id) && ((best == NULL) || (bm->last_accessed > best->last_accessed)))
+                    best = bm;
+            }
+            if (best == NULL)
+                break;
+            // blobs that are busy are passed over rather than waited on
+            if ((reuse[nreuse] = blockblob_open(a->bb->store, best->id, 0, 0, NULL, FIND_BLOB_TIMEOUT_USEC)) != NULL) {
+                reuse_paths[nreuse] = blockblob_get_file(reuse[nreuse]);
+                nreuse++;
+            }
+            best->size_bytes = 0;      // so it is not picked again
+        }
+        for (bm = matches; bm; bm = next) {
+            next = bm->next;
+            EUCA_FREE(bm);
+        }
+    }
+
+    LOGINFO("[%s] downloading chunks of %s, reusing %d cached blobs\n", a->instanceId, a->vbr->preparedResourceLocation, nreuse);
+    if (http_get_chunks(a->vbr->preparedResourceLocation, dest_path, reuse_paths, nreuse, NULL) != EUCA_OK) {
+        LOGERROR("[%s] failed to download component %s\n", a->instanceId, a->vbr->preparedResourceLocation);
+        ret = EUCA_ERROR;
+    }
+
+    for (int i = 0; i < nreuse; i++)
+        blockblob_close(reuse[i]);
+    return (ret);
+}
+
 //!
 //! Creates an artifact by downloading it from objectstorage
 //!
@@ -1054,11 +1640,26 @@ static int objectstorage_creator(artifact * a)
         LOGINFO("[%s] skipping download of %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_OK);
     }
+    peer_unpublish(a);
+    if (peer_fetch(a, dest_path) == EUCA_OK)
+        return (EUCA_OK);
+    if (strlen(vbr->preparedResourceLocation) > strlen(CHUNKS_SUFFIX)
+        && !strcmp(vbr->preparedResourceLocation + strlen(vbr->preparedResourceLocation) - strlen(CHUNKS_SUFFIX), CHUNKS_SUFFIX))
+        return (chunks_fetch(a, dest_path));
     LOGINFO("[%s] downloading %s\n", a->instanceId, vbr->preparedResourceLocation);
 
 #if !defined( _UNIT_TEST) && !defined(_NO_EBS)
     extern struct nc_state_t nc_state;
     char cmd[1024];
+    if (nc_state.stream_image_downloads) {
+        char key_path[EUCA_MAX_PATH];
+        snprintf(key_path, sizeof(key_path), EUCALYPTUS_KEYS_DIR "/cloud-pk.pem", nc_state.home);
+        if (objectstorage_unbundle_by_manifest_url(vbr->preparedResourceLocation, key_path, dest_path, a->bb->size_bytes) == EUCA_OK) {
+            LOGDEBUG("[%s] downloaded and unbundled %s\n", a->instanceId, vbr->preparedResourceLocation);
+            return (EUCA_OK);
+        }
+        LOGWARN("[%s] failed to stream %s, falling back on get_bundle\n", a->instanceId, vbr->preparedResourceLocation);
+    }
     snprintf(cmd, sizeof(cmd), "%s/usr/share/eucalyptus/get_bundle %s %s %s %lld >> /tmp/euca_nc_unbundle.log 2>&1", nc_state.home, nc_state.home, vbr->preparedResourceLocation,
              dest_path, a->bb->size_bytes);
     LOGDEBUG("%s\n", cmd);
@@ -1964,6 +2565,44 @@ static int art_gen_id(char *buf, unsigned int buf_size, const char *first, const
     return (EUCA_OK);
 }
 
+//!
+//! Derives a content key for a bundled image from the digest of the image in its manifest, which
+//! does not change when the same bundle is registered again or the same image is bundled again,
+//! unlike the signature of the artifact
+//!
+//! @param[in] buf
+//! @param[in] buf_size
+//! @param[in] manifest the image manifest
+//! @param[in] size_bytes size of the image
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the manifest has no image digest
+//!
+static int art_gen_content_key(char *buf, unsigned int buf_size, const char *manifest, long long size_bytes)
+{
+    int bytesWritten = 0;
+    char algorithm[32] = "";
+    char hex[MAX_ARTIFACT_CONTENT_KEY] = "";
+    const char *image = NULL;
+    const char *digest = NULL;
+    const char *parts = NULL;
+
+    // the image's own digest comes before the digests of the encrypted parts, which differ on every bundling
+    if (((image = strstr(manifest, "<image>")) == NULL) || ((digest = strstr(image, "<digest")) == NULL))
+        return (EUCA_ERROR);
+    if (((parts = strstr(image, "<parts")) != NULL) && (parts < digest))
+        return (EUCA_ERROR);
+    if ((sscanf(digest, "<digest algorithm=\"%31[A-Za-z0-9]\">%127[0-9A-Fa-f]</digest>", algorithm, hex) != 2) || (strlen(hex) < 32))
+        return (EUCA_ERROR);
+
+    if ((bytesWritten = snprintf(buf, buf_size, "%s-%s-%lld", algorithm, hex, size_bytes)) < 0)
+        return (EUCA_ERROR);
+
+    if (((unsigned)bytesWritten) >= buf_size)   // truncation
+        return (EUCA_ERROR);
+
+    return (EUCA_OK);
+}
+
 //!
 //!
 //!
@@ -2037,17 +2676,18 @@ static void convert_id(const char *src, char *dst, unsigned int size)
 }
 
 //!
+//! Downloads a digest over HTTP
 //!
+//! @param[in]  url
+//! @param[in]  etag OPTIONAL ETag of the copy of the digest the caller has
+//! @param[out] new_etag OPTIONAL buffer for the ETag of the digest
+//! @param[in]  new_etag_size
+//! @param[out] not_modified OPTIONAL set to TRUE if the copy with etag is current, in which case NULL is returned
+//! @param[in]  bail_flag
 //!
-//! @param[in] url
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return the digest, which the caller must free, or NULL
 //!
-static char *url_get_digest(const char *url, boolean * bail_flag)
+static char *url_get_digest(const char *url, const char *etag, char *new_etag, int new_etag_size, boolean * not_modified, boolean * bail_flag)
 {
     char *digest_str = NULL;
     char *digest_path = strdup("/tmp/url-digest-XXXXXX");
@@ -2064,9 +2704,9 @@ static char *url_get_digest(const char *url, boolean * bail_flag)
         close(tmp_fd);
 
         // download a fresh digest
-        if (http_get_timeout(url, digest_path, 10, 4, 0, 0, bail_flag) != 0) {
+        if (http_get_timeout_etag(url, digest_path, 10, 4, 0, 0, etag, new_etag, new_etag_size, not_modified, bail_flag) != 0) {
             LOGERROR("failed to download digest to %s\n", digest_path);
-        } else {
+        } else if (!not_modified || !(*not_modified)) {
             digest_str = file2strn(digest_path, 100000);
         }
         unlink(digest_path);
@@ -2076,26 +2716,162 @@ static char *url_get_digest(const char *url, boolean * bail_flag)
 }
 
 //!
+//! Returns the digest at url, downloading it only if this process has not downloaded it (or
+//! confirmed that it is current) within the last digest_cache_ttl_sec seconds. Threads that
+//! need a digest that another thread is fetching wait for that thread rather than asking too.
 //!
+//! @param[in] url
+//! @param[in] from_objectstorage TRUE to download the digest with a signed objectstorage request, FALSE for plain HTTP
+//! @param[in] bail_flag
 //!
-//! @param[in] vbr
-//! @param[in] do_make_work_copy
-//! @param[in] is_migration_dest
-//! @param[in] must_be_file
-//! @param[in] sshkey
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return the digest, which the caller must free, or NULL on error
 //!
-static artifact *art_alloc_vbr(virtualBootRecord * vbr, boolean do_make_work_copy, boolean is_migration_dest, boolean must_be_file, const char *sshkey, boolean * bail_flag)
+static char *get_cached_digest(const char *url, boolean from_objectstorage, boolean * bail_flag)
 {
-    artifact *a = NULL;
-    char *blob_digest = NULL;
+    boolean not_modified = FALSE;
+    char *digest = NULL;
+    char *fresh = NULL;
+    char etag[DIGEST_ETAG_SIZE] = "";
+    char new_etag[DIGEST_ETAG_SIZE] = "";
+    digest_entry *e = NULL;
+    digest_entry **pe = NULL;
+    digest_entry **oldest = NULL;
+
+    pthread_mutex_lock(&digest_cache_mutex);
+    for (;;) {
+        for (e = digest_cache; e && strcmp(e->url, url); e = e->next) ;
+        if ((e == NULL) || !e->is_fetching)
+            break;
+        pthread_cond_wait(&digest_cache_cond, &digest_cache_mutex); // the entry may be gone once we wake up, so look again
+    }
 
-    switch (vbr->locationType) {
+    if (e && e->digest && ((time(NULL) - e->validated) < digest_cache_ttl_sec)) {
+        long age_sec = (long)(time(NULL) - e->validated);
+        digest = strdup(e->digest);
+        pthread_mutex_unlock(&digest_cache_mutex);
+        LOGDEBUG("[%s] using digest of %s validated %ld sec ago\n", current_instanceId, url, age_sec);
+        return (digest);
+    }
+
+    if (e == NULL) {
+        if (digest_cache_size >= DIGEST_CACHE_ENTRIES) {    // make room by dropping the entry that was validated the longest ago
+            for (pe = &digest_cache; *pe; pe = &((*pe)->next)) {
+                if (!(*pe)->is_fetching && ((oldest == NULL) || ((*pe)->validated < (*oldest)->validated)))
+                    oldest = pe;
+            }
+            if (oldest) {
+                digest_entry *victim = *oldest;
+                *oldest = victim->next;
+                EUCA_FREE(victim->digest);
+                EUCA_FREE(victim);
+                digest_cache_size--;
+            }
+        }
+        if ((e = EUCA_ZALLOC(1, sizeof(digest_entry))) != NULL) {
+            euca_strncpy(e->url, url, sizeof(e->url));
+            e->next = digest_cache;
+            digest_cache = e;
+            digest_cache_size++;
+        }
+    }
+
+    if (e) {
+        e->is_fetching = TRUE;
+        if (e->digest)
+            euca_strncpy(etag, e->etag, sizeof(etag));
+    }
+    pthread_mutex_unlock(&digest_cache_mutex);
+
+    if (from_objectstorage) {
+        fresh = objectstorage_get_digest_etag(url, etag, new_etag, sizeof(new_etag), &not_modified);
+    } else {
+        fresh = url_get_digest(url, etag, new_etag, sizeof(new_etag), &not_modified, bail_flag);
+    }
+
+    if (e == NULL)                     // could not cache it, but the caller can still have it
+        return (fresh);
+
+    pthread_mutex_lock(&digest_cache_mutex);
+    e->is_fetching = FALSE;
+    if (not_modified && e->digest) {
+        LOGDEBUG("[%s] digest of %s has not changed\n", current_instanceId, url);
+        e->validated = time(NULL);
+        digest = strdup(e->digest);
+    } else if (fresh) {
+        EUCA_FREE(e->digest);
+        e->digest = strdup(fresh);
+        euca_strncpy(e->etag, new_etag, sizeof(e->etag));
+        e->validated = time(NULL);
+        digest = fresh;
+        fresh = NULL;
+    }
+    pthread_cond_broadcast(&digest_cache_cond);
+    pthread_mutex_unlock(&digest_cache_mutex);
+
+    EUCA_FREE(fresh);
+    return (digest);
+}
+
+//!
+//! Allocates the artifacts of a whole-disk image that is cached compressed: the cached one,
+//! which the creator downloads and compresses, and the per-instance overlay of it on top
+//!
+//! @param[in] id ID of the image artifact, from which the compressed one's is derived
+//! @param[in] size_bytes size of the raw image
+//! @param[in] creator function that downloads and compresses the image
+//! @param[in] vbr
+//!
+//! @return the overlay artifact, with the cached one as its dependency, or NULL on failure
+//!
+static artifact *art_alloc_compressed(const char *id, long long size_bytes, int (*creator) (artifact * a), virtualBootRecord * vbr)
+{
+    artifact *a = NULL;
+    artifact *a2 = NULL;
+    char art_id[48] = "";
+
+    // compressed and raw images never share a blob, even if the setting changes
+    if (snprintf(art_id, sizeof(art_id), "%s-z", id) >= sizeof(art_id))
+        return (NULL);
+    if ((a = art_alloc(art_id, art_id, size_bytes, TRUE, TRUE, FALSE, creator, vbr)) == NULL)
+        return (NULL);
+    if ((a2 = art_alloc(art_id, art_id, size_bytes, FALSE, TRUE, FALSE, overlay_creator, vbr)) == NULL) {
+        ART_FREE(a);
+        return (NULL);
+    }
+    if (art_add_dep(a2, a) != EUCA_OK) {
+        ART_FREE(a2);
+        ART_FREE(a);
+        return (NULL);
+    }
+    return (a2);
+}
+
+//!
+//!
+//!
+//! @param[in] vbr
+//! @param[in] do_make_work_copy
+//! @param[in] is_migration_dest
+//! @param[in] must_be_file
+//! @param[in] sshkey
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static artifact *art_alloc_vbr(virtualBootRecord * vbr, boolean do_make_work_copy, boolean is_migration_dest, boolean must_be_file, const char *sshkey, boolean * bail_flag)
+{
+    artifact *a = NULL;
+    char *blob_digest = NULL;
+    boolean is_lazy = FALSE;
+    boolean is_compressed = FALSE;
+    // a whole disk may instead be cached compressed, with a qcow2 overlay for a work copy, which
+    // (as with lazy booting) leaves the key to the metadata service rather than injecting it
+    boolean may_compress = (compressed_cache && do_make_work_copy && !is_migration_dest && (vbr->type == NC_RESOURCE_IMAGE) && (vbr->partitionNumber == 0));
+
+    switch (vbr->locationType) {
     case NC_LOCATION_CLC:
         LOGERROR("[%s] location of type %d is NOT IMPLEMENTED\n", current_instanceId, vbr->locationType);
         return NULL;
@@ -2104,7 +2880,7 @@ static artifact *art_alloc_vbr(virtualBootRecord * vbr, boolean do_make_work_cop
             // get the digest for size and signature
             char manifestURL[EUCA_MAX_PATH] = "";
             snprintf(manifestURL, EUCA_MAX_PATH, "%s.manifest.xml", vbr->preparedResourceLocation);
-            blob_digest = url_get_digest(manifestURL, bail_flag);
+            blob_digest = get_cached_digest(manifestURL, FALSE, bail_flag);
             if (blob_digest == NULL)
                 goto u_out;
 
@@ -2119,8 +2895,18 @@ static artifact *art_alloc_vbr(virtualBootRecord * vbr, boolean do_make_work_cop
             if (art_gen_id(art_id, sizeof(art_id), vbr->id, blob_digest) != EUCA_OK)
                 goto u_out;
 
-            // allocate artifact struct
-            a = art_alloc(art_id, art_id, bb_size_bytes, !is_migration_dest, must_be_file, FALSE, url_creator, vbr);
+            // allocate artifact struct: a whole disk may be booted lazily, from an overlay of its own
+            // that is not cached and needs no work copy, while partitions have to be assembled
+            is_lazy = (lazy_boot && !is_migration_dest && (vbr->type == NC_RESOURCE_IMAGE) && (vbr->partitionNumber == 0));
+            is_compressed = (may_compress && !is_lazy);
+            if (is_lazy)
+                a = art_alloc(art_id, art_id, bb_size_bytes, FALSE, TRUE, FALSE, lazy_url_creator, vbr);
+            else if (is_compressed)
+                a = art_alloc_compressed(art_id, bb_size_bytes, compressed_url_creator, vbr);
+            else
+                a = art_alloc(art_id, art_id, bb_size_bytes, !is_migration_dest, must_be_file, FALSE, url_creator, vbr);
+            if (a && !is_compressed && (art_gen_content_key(a->content_key, sizeof(a->content_key), blob_digest, bb_size_bytes) != EUCA_OK))
+                a->content_key[0] = '\0';
 
 u_out:
             EUCA_FREE(blob_digest);
@@ -2128,12 +2914,15 @@ u_out:
         }
     case NC_LOCATION_OBJECT_STORAGE:{
             // get the digest for size and signature
-            if ((blob_digest = objectstorage_get_digest(vbr->preparedResourceLocation)) == NULL) {
+            if ((blob_digest = get_cached_digest(vbr->preparedResourceLocation, TRUE, bail_flag)) == NULL) {
                 LOGERROR("[%s] failed to obtain image digest from  objectstorage\n", current_instanceId);
                 goto w_out;
             }
             // extract size from the digest
             long long bb_size_bytes = euca_strtoll(blob_digest, "<size>", "</size>");   // pull size from the digest
+            char *size_line = strstr(blob_digest, "\nsize ");
+            if ((bb_size_bytes < 1) && (size_line != NULL))
+                bb_size_bytes = strtoll(size_line + 6, NULL, 10);  // chunk manifests have it on a line of its own
             if (bb_size_bytes < 1) {
                 LOGERROR("[%s] incorrect image digest or error returned from objectstorage\n", current_instanceId);
                 goto w_out;
@@ -2147,7 +2936,13 @@ u_out:
                 goto w_out;
             }
             // allocate artifact struct
-            a = art_alloc(art_id, art_id, bb_size_bytes, !is_migration_dest, must_be_file, FALSE, objectstorage_creator, vbr);
+            is_compressed = may_compress;
+            if (is_compressed)
+                a = art_alloc_compressed(art_id, bb_size_bytes, compressed_objectstorage_creator, vbr);
+            else
+                a = art_alloc(art_id, art_id, bb_size_bytes, !is_migration_dest, must_be_file, FALSE, objectstorage_creator, vbr);
+            if (a && !is_compressed && (art_gen_content_key(a->content_key, sizeof(a->content_key), blob_digest, bb_size_bytes) != EUCA_OK))
+                a->content_key[0] = '\0';
 
 w_out:
             EUCA_FREE(blob_digest);
@@ -2271,7 +3066,7 @@ f_out:
     }
     // allocate another artifact struct if a work copy is requested
     // or if an SSH key is supplied
-    if (a && (do_make_work_copy || sshkey)) {
+    if (a && (do_make_work_copy || sshkey) && !is_lazy && !is_compressed) {
 
         artifact *a2 = NULL;
         char art_id[48];
@@ -2737,6 +3532,38 @@ out:
     return root;
 }
 
+//!
+//! Creates a tree of artifacts that brings a single downloadable image, kernel or ramdisk, or a
+//! formatted blank partition, into the cache, without work copies, so that later launches find
+//! it there (caller must free the tree)
+//!
+//! @param[in] vbr the VBR of the image or partition, as prepared for an earlier launch
+//! @param[in] bail_flag
+//! @param[in] instanceId identifier for logging
+//!
+//! @return A pointer to the root of artifact tree or NULL on error
+//!
+artifact *vbr_alloc_image_tree(virtualBootRecord * vbr, boolean * bail_flag, const char *instanceId)
+{
+    artifact *dep = NULL;
+    artifact *root = NULL;
+
+    if (instanceId)
+        euca_strncpy(current_instanceId, instanceId, sizeof(current_instanceId));
+
+    if ((root = art_alloc(instanceId, NULL, -1, FALSE, FALSE, FALSE, NULL, NULL)) == NULL)  // allocate a sentinel artifact
+        return NULL;
+
+    // kernels and ramdisks are always files, as in vbr_alloc_tree()
+    dep = art_alloc_vbr(vbr, FALSE, FALSE, ((vbr->type == NC_RESOURCE_KERNEL) || (vbr->type == NC_RESOURCE_RAMDISK)), NULL, bail_flag);
+    if ((dep == NULL) || (art_add_dep(root, dep) != EUCA_OK)) {
+        ART_FREE(dep);
+        ART_FREE(root);
+        return NULL;
+    }
+    return root;
+}
+
 //!
 //! Either opens a blockblob or creates it
 //!
@@ -2760,12 +3587,14 @@ static int find_or_create_blob(int flags, blobstore * bs, const char *id, long l
 
     // open with a short timeout (0-1000 usec), as we do not want to block
     // here - we let higher-level functions do retries if necessary
+    BENCH_START(started);
     bb = blockblob_open(bs, id, size_bytes, flags, sig, FIND_BLOB_TIMEOUT_USEC);
     if (bb) {                          // success!
         *bbp = bb;
     } else {
         ret = blobstore_get_error();
     }
+    BENCH_STOP(BENCH_STAGE_BLOB_LOCK, started, (((ret == BLOBSTORE_ERROR_AGAIN) || (ret == BLOBSTORE_ERROR_MFILE)) ? EUCA_ERROR : EUCA_OK));
 
     return (ret);
 }
@@ -2833,8 +3662,30 @@ static int find_or_create_artifact(int do_create, artifact * a, blobstore * work
 
     // for a blob first try cache as long as we're allowed to and have one
     if (a->may_be_cached && cache_bs) {
+        // the fast tier only ever gets copies of blobs that are complete in the cache
+        if (!do_create && fast_cache_bs && (fast_cache_bs != cache_bs)) {
+            if ((ret = find_or_create_blob(flags, fast_cache_bs, id_cache, size_bytes, a->sig, bbp)) == BLOBSTORE_ERROR_OK) {
+                LOGDEBUG("[%s] found %03d|%s in the fast tier of the cache\n", a->instanceId, a->seq, id_cache);
+                a->is_in_cache = TRUE;
+                return (ret);
+            }
+        }
+
         ret = find_or_create_blob(flags, cache_bs, id_cache, size_bytes, a->sig, bbp);
 
+        // a blob under a different ID may already have the same content, in which case its signature
+        // is its own and does not need to match, since the content key vouches for the content
+        if (!do_create && ret == BLOBSTORE_ERROR_NOENT && a->content_key[0] != '\0') {
+            char id_alias[BLOBSTORE_MAX_PATH] = "";
+            if (blobstore_get_content_key(cache_bs, a->content_key, id_alias, sizeof(id_alias)) == 0 && strcmp(id_alias, id_cache)) {
+                if ((ret = find_or_create_blob(flags, cache_bs, id_alias, size_bytes, NULL, bbp)) == BLOBSTORE_ERROR_OK) {
+                    LOGINFO("[%s] using cached blob %s with the same content for %03d|%s\n", a->instanceId, id_alias, a->seq, id_cache);
+                } else if (ret != BLOBSTORE_ERROR_AGAIN && ret != BLOBSTORE_ERROR_MFILE) {
+                    ret = BLOBSTORE_ERROR_NOENT;    // the alias is of no use, so this artifact will be created after all
+                }
+            }
+        }
+
         // for some error conditions from cache we try work blobstore
         if ((do_create && ret == BLOBSTORE_ERROR_NOSPC) || (!do_create && ret == BLOBSTORE_ERROR_NOENT) || (ret == BLOBSTORE_ERROR_SIGNATURE)
             // these reduce reliance on cache (work copies are created more aggressively)
@@ -2860,6 +3711,259 @@ try_work:
     return find_or_create_blob(flags, work_bs, id_work, size_bytes, a->sig, bbp);
 }
 
+//!
+//! Finds the creation of a cached artifact that is in progress in this process and signs up
+//! to wait on it or, if there is none and 'may_lead' is set, registers one for the caller to
+//! carry out. Either way, the caller must let go of what it gets, with art_flight_wait() or
+//! art_flight_finish() respectively.
+//!
+//! @param[in]  a artifact that is about to be created in the cache
+//! @param[in]  cache_bs the cache blobstore
+//! @param[in]  may_lead set to TRUE to register a new creation if there is none
+//! @param[out] is_leader set to TRUE if the caller is to carry out the creation
+//!
+//! @return the creation or NULL if there is none (or it could not be registered)
+//!
+static art_flight *art_flight_join(const artifact * a, const blobstore * cache_bs, boolean may_lead, boolean * is_leader)
+{
+    art_flight *f = NULL;
+
+    *is_leader = FALSE;
+    pthread_mutex_lock(&art_flights_mutex);
+    for (f = art_flights; f; f = f->next) {
+        if (f->bs == cache_bs && !strcmp(f->id, a->id))
+            break;
+    }
+
+    if (f) {
+        f->refs++;
+    } else if (may_lead && (f = EUCA_ZALLOC(1, sizeof(art_flight))) != NULL) {
+        euca_strncpy(f->id, a->id, sizeof(f->id));
+        euca_strncpy(f->leader, a->instanceId, sizeof(f->leader));
+        f->bs = cache_bs;
+        f->size_bytes = a->size_bytes;
+        f->refs = 1;
+        pthread_cond_init(&(f->cond), NULL);
+        f->next = art_flights;
+        art_flights = f;
+        *is_leader = TRUE;
+    }
+    pthread_mutex_unlock(&art_flights_mutex);
+    return (f);
+}
+
+//!
+//! Drops a reference to a creation, freeing it with the last one
+//!
+//! @param[in] f
+//!
+//! @pre The art_flights_mutex must be held and the creation must be done.
+//!
+static void art_flight_release(art_flight * f)
+{
+    if (--(f->refs) == 0) {
+        pthread_cond_destroy(&(f->cond));
+        EUCA_FREE(f);
+    }
+}
+
+//!
+//! Records the file of the blob being created, so that waiters can tell how far along it is
+//!
+//! @param[in] f creation carried out by the caller
+//! @param[in] path
+//!
+static void art_flight_set_path(art_flight * f, const char *path)
+{
+    pthread_mutex_lock(&art_flights_mutex);
+    euca_strncpy(f->path, path, sizeof(f->path));
+    pthread_mutex_unlock(&art_flights_mutex);
+}
+
+//!
+//! Marks a creation carried out by the caller as done, handing its outcome to all waiters at
+//! once, and lets go of it. A new creation of the same artifact may be registered after this.
+//!
+//! @param[in] f
+//! @param[in] ret outcome of the creation, as art_implement_tree() would return it
+//!
+static void art_flight_finish(art_flight * f, int ret)
+{
+    pthread_mutex_lock(&art_flights_mutex);
+    for (art_flight ** fp = &art_flights; *fp; fp = &((*fp)->next)) {
+        if (*fp == f) {
+            *fp = f->next;
+            break;
+        }
+    }
+    f->is_done = TRUE;
+    f->ret = ret;
+    if (f->refs > 1)
+        LOGDEBUG("[%s] handing outcome %d of %s to %d waiting thread(s)\n", f->leader, ret, f->id, f->refs - 1);
+    pthread_cond_broadcast(&(f->cond));
+    art_flight_release(f);
+    pthread_mutex_unlock(&art_flights_mutex);
+}
+
+//!
+//! Waits for a creation carried out by another thread to be done, reporting how much of the
+//! blob has been written every ART_FLIGHT_REPORT_USEC, and lets go of it
+//!
+//! @param[in] f
+//! @param[in] a artifact of the waiting thread, for logging
+//! @param[in] timeout_usec how long to wait, in microseconds or 0 for no timeout
+//!
+//! @return the outcome of the creation or BLOBSTORE_ERROR_AGAIN if it took longer than the timeout
+//!
+static int art_flight_wait(art_flight * f, const artifact * a, long long timeout_usec)
+{
+    int ret = BLOBSTORE_ERROR_AGAIN;
+    long long now = mono_time_usec();
+    long long deadline = (timeout_usec > 0) ? (now + timeout_usec) : 0;
+    long long wake = 0;
+    struct stat sb = { 0 };
+    struct timespec ts = { 0 };
+
+    LOGINFO("[%s] waiting for %03d|%s to be created by [%s]\n", a->instanceId, a->seq, a->id, f->leader);
+    pthread_mutex_lock(&art_flights_mutex);
+    while (!f->is_done) {
+        now = mono_time_usec();
+        if (deadline && now >= deadline)
+            break;
+        wake = now + ART_FLIGHT_REPORT_USEC;
+        if (deadline && wake > deadline)
+            wake = deadline;
+        ts.tv_sec = wake / 1000000;
+        ts.tv_nsec = (wake % 1000000) * 1000;
+        if ((pthread_cond_timedwait(&(f->cond), &art_flights_mutex, &ts) == ETIMEDOUT) && !f->is_done && (wake != deadline)) {
+            if (f->path[0] != '\0' && stat(f->path, &sb) == 0) {
+                LOGINFO("[%s] still waiting for %03d|%s: %lld of %lld MB written\n", a->instanceId, a->seq, a->id, ((long long)sb.st_blocks * 512) / MEGABYTE,
+                        f->size_bytes / MEGABYTE);
+            } else {
+                LOGINFO("[%s] still waiting for %03d|%s: its dependencies are being prepared\n", a->instanceId, a->seq, a->id);
+            }
+        }
+    }
+
+    if (f->is_done)
+        ret = f->ret;
+    art_flight_release(f);
+    pthread_mutex_unlock(&art_flights_mutex);
+
+    if (ret == BLOBSTORE_ERROR_AGAIN || ret == BLOBSTORE_ERROR_MFILE) {
+        LOGDEBUG("[%s] gave up waiting for %03d|%s to be created\n", a->instanceId, a->seq, a->id);
+    } else if (ret != BLOBSTORE_ERROR_OK) {
+        LOGERROR("[%s] creation of %03d|%s by another instance failed (error=%d)\n", a->instanceId, a->seq, a->id, ret);
+    }
+    return (ret);
+}
+
+//!
+//! Tells whether no part of the tree under an artifact is shared with other trees, in which
+//! case the artifact can be implemented alongside its siblings
+//!
+//! @param[in] a
+//!
+//! @return TRUE if every artifact in the tree is a dependency of just one other
+//!
+static boolean art_is_exclusive(const artifact * a)
+{
+    if (a->refs > 1)
+        return (FALSE);
+    for (int i = 0; i < MAX_ARTIFACT_DEPS && a->deps[i]; i++) {
+        if (!art_is_exclusive(a->deps[i]))
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+//!
+//! Creates the pool of workers that implement branches, once per process
+//!
+static void art_pool_init(void)
+{
+    if ((art_pool = thread_pool_create("vbr", ART_IMPLEMENT_WORKERS)) == NULL)
+        LOGWARN("failed to start the workers implementing dependencies, implementing them in line\n");
+}
+
+//!
+//! Implements one branch of an artifact tree, as a task of art_pool. The worker may be in the
+//! middle of another branch, for which it waits, so its instance ID is put back when done.
+//!
+//! @param[in] arg pointer to the art_branch to implement
+//!
+//! @return Always return NULL
+//!
+static void *art_branch_thread(void *arg)
+{
+    art_branch *b = arg;
+    char instanceId[sizeof(current_instanceId)] = "";
+
+    euca_strncpy(instanceId, current_instanceId, sizeof(instanceId));
+    euca_strncpy(current_instanceId, b->instanceId, sizeof(current_instanceId));
+    b->ret = art_implement_tree(b->a, b->work_bs, b->cache_bs, b->work_prefix, b->timeout_usec);
+    euca_strncpy(current_instanceId, instanceId, sizeof(current_instanceId));
+    return NULL;
+}
+
+//!
+//! Implements all dependencies of an artifact, those that are independent of one another in
+//! parallel. A dependency whose tree holds nothing that other trees share is submitted to
+//! art_pool, while the calling thread implements the rest, in order, and then any submitted
+//! branch that no worker has started yet. Each branch opens and locks its blobs just as it
+//! would on its own, so branches that need the same cached blob still take turns. All branches
+//! are finished by the time this returns, whether or not some of them failed.
+//!
+//! @param[in]  root artifact whose dependencies are to be implemented
+//! @param[in]  work_bs pointer to work blobstore
+//! @param[in]  cache_bs pointer to OPTIONAL cache blobstore
+//! @param[in]  work_prefix OPTIONAL instance-specific prefix for forming work blob IDs
+//! @param[in]  timeout_usec timeout for each branch, in microseconds or 0 for no timeout
+//! @param[out] branches array of MAX_ARTIFACT_DEPS, to be filled out with the result of each dependency
+//!
+//! @return the number of dependencies
+//!
+static int art_implement_deps(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec, art_branch * branches)
+{
+    int num_deps = 0;
+    int inline_deps = 0;
+
+    for (num_deps = 0; num_deps < MAX_ARTIFACT_DEPS && root->deps[num_deps]; num_deps++) {
+        art_branch *b = &(branches[num_deps]);
+        bzero(b, sizeof(art_branch));
+        b->a = root->deps[num_deps];
+        b->work_bs = work_bs;
+        b->cache_bs = cache_bs;
+        b->work_prefix = work_prefix;
+        b->timeout_usec = timeout_usec;
+        euca_strncpy(b->instanceId, current_instanceId, sizeof(b->instanceId));
+        if (!art_is_exclusive(b->a))
+            inline_deps++;
+    }
+
+    // the calling thread takes the shared branches or, if there are none, the last one
+    pthread_once(&art_pool_once, art_pool_init);
+    for (int i = 0; i < num_deps; i++) {
+        art_branch *b = &(branches[i]);
+        if (((inline_deps == 0) && (i == (num_deps - 1))) || !art_is_exclusive(b->a))
+            continue;
+
+        if ((b->future = thread_pool_submit(art_pool, art_branch_thread, b)) != NULL)
+            LOGDEBUG("[%s] implementing dependency %03d|%s of %03d|%s in parallel\n", root->instanceId, b->a->seq, b->a->id, root->seq, root->id);
+    }
+
+    for (int i = 0; i < num_deps; i++) {
+        if (branches[i].future == NULL)
+            branches[i].ret = art_implement_tree(branches[i].a, work_bs, cache_bs, work_prefix, timeout_usec);
+    }
+
+    for (int i = 0; i < num_deps; i++) {
+        if (branches[i].future != NULL)
+            thread_pool_wait(branches[i].future);
+    }
+    return (num_deps);
+}
+
 //!
 //! Traverse artifact tree and create/download/combine artifacts
 //!
@@ -2875,7 +3979,10 @@ try_work:
 //! \li with success, the root blob is open and ready
 //! \li with failure, the root blob is closed and possibly non-existant
 //!
-//! Either way, none of the child blobs are open.
+//! Either way, none of the child blobs are open. Dependencies that do not share
+//! any artifacts are implemented in parallel (see art_implement_deps()). Threads of
+//! this process that need a cached artifact another thread is creating wait for it
+//! to be done and take its outcome, rather than each polling the lock of its blob.
 //!
 //! @param[in] root pointer to root of the tree
 //! @param[in] work_bs pointero to work blobstore
@@ -2891,20 +3998,28 @@ try_work:
 //!
 int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec)
 {
-    long long started = time_usec();
+    long long started = mono_time_usec();
     assert(root);
 
     LOGDEBUG("[%s] implementing artifact %03d|%s\n", root->instanceId, root->seq, root->id);
 
     int ret = EUCA_OK;
     int tries = 0;
+    boolean is_shared = (root->creator && root->may_be_cached && cache_bs && !root->id_is_path);   // others in this process may need the same blob
+    boolean do_sleep = TRUE;
     do {                               // we may have to retry multiple times due to competition
         int num_opened_deps = 0;
         boolean do_deps = TRUE;
         boolean do_create = TRUE;
+        boolean is_leader = FALSE;
+        art_flight *flight = NULL;
 
-        if (tries++)
+        if (tries++ && do_sleep) {
+            BENCH_START(slept);
             usleep(ARTIFACT_RETRY_SLEEP_USEC);
+            BENCH_STOP(BENCH_STAGE_RETRY_SLEEP, slept, EUCA_OK);
+        }
+        do_sleep = TRUE;
 
         if (!root->creator) {          // sentinel nodes do not have a creator
             do_create = FALSE;
@@ -2919,14 +4034,31 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
                 LOGDEBUG("[%s] found existing artifact %03d|%s on try %d\n", root->instanceId, root->seq, root->id, tries);
                 if (work_bs && blockblob_get_blobstore(root->bb) == work_bs)
                     update_vbr_with_backing_info(root);
+                if (root->is_in_cache && root->content_key[0] != '\0') {    // blobs cached before content was recorded get recorded here
+                    blobstore_put_content_key(cache_bs, root->content_key, root->bb->id);
+                    peer_publish(root);
+                }
                 do_deps = FALSE;
                 do_create = FALSE;
                 break;
-            case BLOBSTORE_ERROR_NOENT:    // doesn't exist yet => ok, create it
-                break;
+            case BLOBSTORE_ERROR_NOENT:    // doesn't exist yet => ok, create it, unless another thread is doing so
             case BLOBSTORE_ERROR_AGAIN:    // timed out the => competition took too long
             case BLOBSTORE_ERROR_MFILE:    // out of file descriptors for locking => same problem
-                goto retry_or_fail;
+                if (is_shared)
+                    flight = art_flight_join(root, cache_bs, (ret == BLOBSTORE_ERROR_NOENT), &is_leader);
+                if (flight && !is_leader) {
+                    BENCH_START(waited);
+                    ret = art_flight_wait(flight, root, ((timeout_usec > 0) ? (timeout_usec - (mono_time_usec() - started)) : 0));
+                    BENCH_STOP(BENCH_STAGE_FLIGHT_WAIT, waited, ret);
+                    flight = NULL;
+                    if (ret == BLOBSTORE_ERROR_OK) {    // it exists now => loop back right away and open it
+                        ret = BLOBSTORE_ERROR_AGAIN;
+                        do_sleep = FALSE;
+                    }
+                    goto retry_or_fail;
+                }
+                if (ret != BLOBSTORE_ERROR_NOENT)
+                    goto retry_or_fail;
                 break;
             default:                  // all other errors
                 LOGERROR("[%s] failed to provision artifact %03d|%s (error=%d) on try %d\n", root->instanceId, root->seq, root->id, ret, tries);
@@ -2937,38 +4069,55 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
         // at this point the artifact we need does not seem to exist
         // (though it could be created before we get around to that)
 
-        if (do_deps) {                 // recursively go over dependencies, if any
-            for (int i = 0; i < MAX_ARTIFACT_DEPS && root->deps[i]; i++) {
+        if (do_deps && root->deps[0]) { // recursively go over dependencies, if any
+            art_branch branches[MAX_ARTIFACT_DEPS];
+            int num_deps = 0;
 
-                // recalculate the time that remains in the timeout period
-                long long new_timeout_usec = timeout_usec;
-                if (timeout_usec > 0) {
-                    new_timeout_usec -= time_usec() - started;
-                    if (new_timeout_usec < 1) { // timeout exceeded, so bail out of this function
-                        ret = BLOBSTORE_ERROR_AGAIN;
-                        goto retry_or_fail;
-                    }
+            // recalculate the time that remains in the timeout period
+            long long new_timeout_usec = timeout_usec;
+            if (timeout_usec > 0) {
+                new_timeout_usec -= mono_time_usec() - started;
+                if (new_timeout_usec < 1) { // timeout exceeded, so bail out of this function
+                    ret = BLOBSTORE_ERROR_AGAIN;
+                    goto retry_or_fail;
                 }
-                switch (ret = art_implement_tree(root->deps[i], work_bs, cache_bs, work_prefix, new_timeout_usec)) {
+            }
+
+            ret = BLOBSTORE_ERROR_OK;
+            num_deps = art_implement_deps(root, work_bs, cache_bs, work_prefix, new_timeout_usec, branches);
+            for (int i = 0; i < num_deps; i++) {
+                switch (branches[i].ret) {
                 case BLOBSTORE_ERROR_OK:
-                    if (do_create) {   // we'll hold the dependency open for the creator
-                        num_opened_deps++;
-                    } else {           // this is a sentinel, we're not creating anything, so release the dep immediately
-                        if (root->deps[i]->bb && (blockblob_close(root->deps[i]->bb) == -1)) {
-                            LOGERROR("[%s] failed to close dependency of %s: %d %s (potential resource leak!) on try %d\n",
-                                     root->instanceId, root->id, blobstore_get_error(), blobstore_get_last_msg(), tries);
-                        }
-                        root->deps[i]->bb = 0;  // for debugging
-                    }
-                    break;             // out of the switch statement
+                    break;
                 case BLOBSTORE_ERROR_AGAIN:    // timed out => the competition took too long
                 case BLOBSTORE_ERROR_MFILE:    // out of file descriptors for locking => same problem
-                    goto retry_or_fail;
-                default:              // all other errors
-                    LOGERROR("[%s] failed to provision dependency %s for artifact %s (error=%d) on try %d\n", root->instanceId, root->deps[i]->id, root->id, ret, tries);
-                    goto retry_or_fail;
+                    if (ret == BLOBSTORE_ERROR_OK)
+                        ret = branches[i].ret;
+                    break;
+                default:              // all other errors, which take precedence since retrying will not help
+                    LOGERROR("[%s] failed to provision dependency %s for artifact %s (error=%d) on try %d\n", root->instanceId, root->deps[i]->id, root->id,
+                             branches[i].ret, tries);
+                    if (ret == BLOBSTORE_ERROR_OK || ret == BLOBSTORE_ERROR_AGAIN || ret == BLOBSTORE_ERROR_MFILE)
+                        ret = branches[i].ret;
+                    break;
                 }
             }
+
+            for (int i = 0; i < num_deps; i++) {
+                if (branches[i].ret != BLOBSTORE_ERROR_OK)
+                    continue;
+                if (do_create && ret == BLOBSTORE_ERROR_OK) {   // we'll hold the dependency open for the creator
+                    num_opened_deps++;
+                } else {               // this is a sentinel or a sibling failed, so release the dep immediately
+                    if (root->deps[i]->bb && (blockblob_close(root->deps[i]->bb) == -1)) {
+                        LOGERROR("[%s] failed to close dependency of %s: %d %s (potential resource leak!) on try %d\n",
+                                 root->instanceId, root->id, blobstore_get_error(), blobstore_get_last_msg(), tries);
+                    }
+                    root->deps[i]->bb = 0;  // for debugging
+                }
+            }
+            if (ret != BLOBSTORE_ERROR_OK)
+                goto retry_or_fail;
         }
         // at this point the dependencies, if any, needed to create
         // the artifact, have been created and opened (i.e. locked
@@ -2993,6 +4142,8 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
                 switch (ret = find_or_create_artifact(CREATE, root, work_bs, cache_bs, work_prefix, &(root->bb))) {
                 case BLOBSTORE_ERROR_OK:
                     LOGDEBUG("[%s] created a blob for an artifact %03d|%s on try %d\n", root->instanceId, root->seq, root->id, tries);
+                    if (flight && root->bb)
+                        art_flight_set_path(flight, root->bb->blocks_path);
                     break;
                 case BLOBSTORE_ERROR_EXIST:    // someone else created it => loop back and open it
                     ret = BLOBSTORE_ERROR_AGAIN;
@@ -3010,7 +4161,9 @@ int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_b
             }
 
 create:
-            ret = root->creator(root); // create and open this artifact for exclusive use
+            EUCA_PROBE1(vbr__create__start, root->id);
+            ret = ART_CREATE(root);    // create and open this artifact for exclusive use
+            EUCA_PROBE2(vbr__create__done, root->id, ret);
             if (ret != EUCA_OK) {
                 LOGERROR("[%s] failed to create artifact %s (error=%d, may retry) on try %d\n", root->instanceId, root->id, ret, tries);
                 // delete the partially created artifact so we can retry with a clean slate
@@ -3034,6 +4187,12 @@ create:
                 if (root->vbr && root->vbr->type != NC_RESOURCE_EBS)
                     if (work_bs && blockblob_get_blobstore(root->bb) == work_bs)
                         update_vbr_with_backing_info(root);
+                // let artifacts with other IDs but the same content find this blob in cache
+                if (root->is_in_cache && root->content_key[0] != '\0' && root->bb
+                    && blobstore_put_content_key(cache_bs, root->content_key, root->bb->id) != 0) {
+                    LOGWARN("[%s] failed to record content of cached artifact %03d|%s\n", root->instanceId, root->seq, root->id);
+                }
+                peer_publish(root);
             }
         }
 
@@ -3045,9 +4204,13 @@ retry_or_fail:
             root->deps[i]->bb = 0;     // for debugging
         }
 
+        // let the threads waiting on this creation know how it went
+        if (flight)
+            art_flight_finish(flight, ret);
+
     } while ((ret == BLOBSTORE_ERROR_AGAIN || ret == BLOBSTORE_ERROR_MFILE) // only timeout-type error causes us to keep trying
              && (timeout_usec == 0     // indefinitely if there is no timeout at all
-                 || (time_usec() - started) < timeout_usec));   // or until we exceed the timeout
+                 || (mono_time_usec() - started) < timeout_usec));   // or until we exceed the timeout
 
     if (ret != EUCA_OK) {
         LOGDEBUG("[%s] failed to implement artifact %03d|%s on try %d\n", root->instanceId, root->seq, root->id, tries);
@@ -3354,6 +4517,387 @@ static void dummy_err_fn(const char *msg)
     LOGDEBUG("BLOBSTORE: %s\n", msg);
 }
 
+#ifdef _BENCHMARK
+//!
+//! Records one timed call of a stage. Stages are timed in every thread, including the workers
+//! that implement branches of a tree, so the samples are shared under bench_mutex.
+//!
+//! @param[in] stage
+//! @param[in] started mono_time_usec() when the call began
+//! @param[in] ret outcome of the call, EUCA_OK on success
+//!
+static void bench_record(bench_stage stage, long long started, int ret)
+{
+    long long usec = mono_time_usec() - started;
+    long long *grown = NULL;
+    bench_samples *s = &(bench_samples_of[stage]);
+
+    pthread_mutex_lock(&bench_mutex);
+    {
+        if (ret != EUCA_OK)
+            s->failed++;
+        if (s->len == s->size) {
+            if ((grown = EUCA_REALLOC(s->usec, ((s->size * 2) + 64), sizeof(long long))) != NULL) {
+                s->usec = grown;
+                s->size = (s->size * 2) + 64;
+            }
+        }
+        if (s->len < s->size)
+            s->usec[s->len++] = usec;
+    }
+    pthread_mutex_unlock(&bench_mutex);
+}
+
+//!
+//! Runs the creator of an artifact and records its latency under the stage it belongs to
+//!
+//! @param[in] a the artifact to create
+//!
+//! @return the result of the creator
+//!
+static int bench_creator(artifact * a)
+{
+    int ret = EUCA_ERROR;
+    long long started = mono_time_usec();
+    bench_stage stage = BENCH_STAGE_DOWNLOAD;
+
+    if (a->creator == partition_creator) {
+        stage = BENCH_STAGE_PARTITION;
+    } else if ((a->creator == disk_creator) || (a->creator == disk_expander)) {
+        stage = BENCH_STAGE_DISK;
+    } else if (a->creator == copy_creator) {
+        stage = BENCH_STAGE_COPY;
+#ifndef _NO_EBS
+    } else if (a->creator == iqn_creator) {
+        stage = BENCH_STAGE_IQN;
+#endif /* ! _NO_EBS */
+    }
+
+    ret = a->creator(a);
+    bench_record(stage, started, ret);
+    return (ret);
+}
+
+//!
+//! qsort() comparator of latencies
+//!
+static int bench_compare(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints the per-stage latency table, one 'vbr_bench' line of key=value pairs per stage that
+//! was reached, followed by a summary of the run. The 'total_us' of each stage is the time all
+//! threads together spent in it, so it tells where provisioning time goes, while the percentiles
+//! tell how evenly it is spread over the calls.
+//!
+//! @param[in] out stream to print to
+//! @param[in] config key=value pairs describing the launch mix
+//! @param[in] elapsed_usec wall-clock time of the run
+//!
+static void bench_report(FILE * out, const char *config, long long elapsed_usec)
+{
+    int launched = 0;
+    int failed = 0;
+    long long total = 0;
+    bench_samples *s = NULL;
+
+    for (int i = 0; i < BENCH_STAGES; i++) {
+        s = &(bench_samples_of[i]);
+        if (s->len == 0)
+            continue;
+
+        qsort(s->usec, s->len, sizeof(long long), bench_compare);
+        total = 0;
+        for (int j = 0; j < s->len; j++)
+            total += s->usec[j];
+
+#define _PCT(_F)                       (s->usec[MIN(s->len - 1, (int)((_F) * s->len))])
+        fprintf(out, "vbr_bench stage=%s %s calls=%d failed=%d total_us=%lld mean_us=%lld p50_us=%lld p90_us=%lld p99_us=%lld max_us=%lld\n",
+                bench_stage_names[i], config, s->len, s->failed, total, (total / s->len), _PCT(0.50), _PCT(0.90), _PCT(0.99), _PCT(1.0));
+#undef _PCT
+    }
+
+    launched = bench_samples_of[BENCH_STAGE_LAUNCH].len;
+    failed = bench_samples_of[BENCH_STAGE_LAUNCH].failed;
+    fprintf(out, "vbr_bench stage=summary %s calls=%d failed=%d elapsed_us=%lld launches_per_sec=%.2f\n", config, launched, failed, elapsed_usec,
+            ((elapsed_usec > 0) ? ((launched - failed) * 1000000.0 / elapsed_usec) : 0.0));
+    fflush(out);
+
+    for (int i = 0; i < BENCH_STAGES; i++) {
+        EUCA_FREE(bench_samples_of[i].usec);
+        bzero(&(bench_samples_of[i]), sizeof(bench_samples));
+    }
+}
+
+//!
+//! Parses a comma-separated list of image sizes in MB, each optionally followed by ':' and its
+//! weight in the launch mix (1 by default), e.g. "8:6,32:3,128:1"
+//!
+//! @param[in]  list
+//! @param[out] sizes
+//! @param[out] weights
+//! @param[in]  max room in sizes[] and weights[]
+//!
+//! @return the number of sizes or -1 if the list is malformed
+//!
+static int bench_parse_sizes(const char *list, int *sizes, int *weights, int max)
+{
+    int len = 0;
+    char *end = NULL;
+    const char *p = list;
+
+    while (*p != '\0') {
+        if (len == max)
+            return (-1);
+        sizes[len] = (int)strtol(p, &end, 10);
+        weights[len] = 1;
+        if (*end == ':')
+            weights[len] = (int)strtol(end + 1, &end, 10);
+        if ((end == p) || (sizes[len] < 1) || (weights[len] < 1) || ((*end != ',') && (*end != '\0')))
+            return (-1);
+        len++;
+        p = ((*end == ',') ? (end + 1) : end);
+    }
+    return (len);
+}
+
+//!
+//! Creates a sparse image file, which the file creator copies into the cache as the download
+//! of a real launch would, without the benchmark depending on an object storage
+//!
+//! @param[in] path
+//! @param[in] size_mb
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int bench_make_image(const char *path, int size_mb)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+
+    if ((fd = open(path, (O_CREAT | O_WRONLY | O_TRUNC), 0600)) < 0) {
+        printf("ERROR: failed to create image %s\n", path);
+        return (EUCA_ERROR);
+    }
+    if ((ftruncate(fd, (((off_t) size_mb) * MEGABYTE)) != 0) || (write(fd, path, strlen(path)) < 0)) {
+        printf("ERROR: failed to size image %s\n", path);
+        ret = EUCA_ERROR;
+    }
+    close(fd);
+    return (ret);
+}
+
+//!
+//! Provisions one launch of the mix, as the NC does, with a kernel, a ramdisk, the image as the
+//! root partition and ephemeral and swap partitions, then deletes its work blobs since an NC
+//! does not keep many instances around
+//!
+//! @param[in] l the launch
+//! @param[in] n its position in the mix, which makes the instance ID
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int bench_provision(const bench_launch * l, int n)
+{
+    int ret = EUCA_ERROR;
+    long long started = 0;
+    char id[64] = "";
+    char regex[128] = "";
+    char *path = NULL;
+    artifact *sentinel = NULL;
+    virtualMachine *vm = NULL;
+
+    if (((vm = EUCA_ZALLOC(1, sizeof(virtualMachine))) == NULL) || ((path = strdup(l->image)) == NULL)) {
+        EUCA_FREE(vm);
+        return (1);
+    }
+
+    snprintf(id, sizeof(id), "bench/i-%08x", n);
+    add_vbr(vm, EKI_SIZE, NC_FORMAT_NONE, "none", EKI1, NC_RESOURCE_KERNEL, NC_LOCATION_NONE, 0, 0, 0, NULL);
+    add_vbr(vm, EKI_SIZE, NC_FORMAT_NONE, "none", ERI1, NC_RESOURCE_RAMDISK, NC_LOCATION_NONE, 0, 0, 0, NULL);
+    add_vbr(vm, (l->size_mb * MEGABYTE), NC_FORMAT_EXT3, "ext3", basename(path), NC_RESOURCE_IMAGE, NC_LOCATION_FILE, 0, 1, BUS_TYPE_SCSI, (char *)l->image);
+    add_vbr(vm, VBR_SIZE, NC_FORMAT_EXT3, "ext3", "none", NC_RESOURCE_EPHEMERAL, NC_LOCATION_NONE, 0, 3, BUS_TYPE_SCSI, NULL);
+    add_vbr(vm, VBR_SIZE, NC_FORMAT_SWAP, "swap", "none", NC_RESOURCE_SWAP, NC_LOCATION_NONE, 0, 2, BUS_TYPE_SCSI, NULL);
+    EUCA_FREE(path);
+
+    euca_strncpy(current_instanceId, strstr(id, "/") + 1, sizeof(current_instanceId));
+    started = mono_time_usec();
+    if ((sentinel = vbr_alloc_tree(vm, FALSE, TRUE, FALSE, bench_sshkey, NULL, id)) != NULL) {
+        ret = art_implement_tree(sentinel, work_bs, cache_bs, id, BENCH_TIMEOUT_USEC);
+    }
+    bench_record(BENCH_STAGE_LAUNCH, started, ret);
+    if (ret != EUCA_OK)
+        printf("ERROR: failed to provision %s with %s (%d)\n", id, l->image, ret);
+
+    if (sentinel)
+        ART_FREE(sentinel);
+    snprintf(regex, sizeof(regex), "%s/.*", id);
+    blobstore_delete_regex(work_bs, regex);
+    EUCA_FREE(vm);
+    return ((ret == EUCA_OK) ? 0 : 1);
+}
+
+//!
+//! Thread of the benchmark: provisions launches of the mix, in order, until none are left
+//!
+//! @param[in] ptr where to count the launches that failed
+//!
+//! @return Always NULL
+//!
+static void *bench_worker(void *ptr)
+{
+    int n = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&bench_mutex);
+        n = bench_next++;
+        pthread_mutex_unlock(&bench_mutex);
+        if (n >= bench_launches_len)
+            break;
+        *((int *)ptr) += bench_provision(&(bench_launches[n]), n);
+    }
+    return (NULL);
+}
+
+//!
+//! Replays a launch mix against a cache and a work blobstore and prints how long each stage of
+//! provisioning took.
+//!
+//! Usage: bench_vbr [-n launches] [-c concurrency] [-s size:weight,...] [-h hit_percent] [-k] [-o file]
+//!
+//! The mix is drawn up front: each launch picks an image size by weight and, with the hit
+//! probability, an image of that size that an earlier launch used, or else a new image. Launches
+//! of the same image then compete the way concurrent launches on an NC do, which is what the
+//! flight_wait, blob_lock and retry_sleep stages measure. With -k an SSH key is injected into
+//! every root disk, which needs the privileges that the NC has.
+//!
+//! @param[in] base directory in which the blobstores were created
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+static int do_benchmark(const char *base, int argc, char **argv)
+{
+    int ch = 0;
+    int k = 0;
+    int pick = 0;
+    int errors = 0;
+    int hits = 0;
+    int images = 0;
+    int sizes_len = 0;
+    int total_weight = 0;
+    int launches = BENCH_DEFAULT_LAUNCHES;
+    int concurrency = BENCH_DEFAULT_CONCURRENCY;
+    int hit_percent = BENCH_DEFAULT_HIT_PERCENT;
+    int sizes[BENCH_MAX_SIZES] = { 0 };
+    int weights[BENCH_MAX_SIZES] = { 0 };
+    int images_of[BENCH_MAX_SIZES] = { 0 };
+    int thread_errors[BENCH_MAX_THREADS] = { 0 };
+    long long started = 0;
+    char dir[EUCA_MAX_PATH] = "";
+    char config[256] = "";
+    char *sizes_opt = BENCH_DEFAULT_SIZES;
+    FILE *out = stdout;
+    pthread_t threads[BENCH_MAX_THREADS];
+
+    while ((ch = getopt(argc, argv, "n:c:s:h:ko:")) != -1) {
+        switch (ch) {
+        case 'n':
+            launches = atoi(optarg);
+            break;
+        case 'c':
+            concurrency = MIN(atoi(optarg), BENCH_MAX_THREADS);
+            break;
+        case 's':
+            sizes_opt = optarg;
+            break;
+        case 'h':
+            hit_percent = atoi(optarg);
+            break;
+        case 'k':
+            bench_sshkey = KEY1;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            printf("Usage: bench_vbr [-n launches] [-c concurrency] [-s size:weight,...] [-h hit_percent] [-k] [-o file]\n");
+            return (1);
+        }
+    }
+
+    if ((launches < 1) || (concurrency < 1) || (hit_percent < 0) || (hit_percent > 100)
+        || ((sizes_len = bench_parse_sizes(sizes_opt, sizes, weights, BENCH_MAX_SIZES)) < 1)) {
+        printf("ERROR: need positive launches and concurrency, a hit percentage of 0-100 and sizes as MB[:weight],...\n");
+        return (1);
+    }
+    for (int i = 0; i < sizes_len; i++)
+        total_weight += weights[i];
+
+    snprintf(dir, sizeof(dir), "%s/test_vbr_images_%d", base, getpid());
+    if ((mkdir(dir, 0700) == -1) || ((bench_launches = EUCA_ZALLOC(launches, sizeof(bench_launch))) == NULL)) {
+        printf("ERROR: failed to set up %s\n", dir);
+        return (1);
+    }
+
+    // draw the mix and create its images, which is not part of what is timed
+    for (int n = 0; (n < launches) && (errors == 0); n++) {
+        bench_launch *l = &(bench_launches[n]);
+
+        pick = rand() % total_weight;
+        for (k = 0; pick >= weights[k]; k++)
+            pick -= weights[k];
+        l->size_mb = sizes[k];
+        l->is_hit = ((images_of[k] > 0) && ((rand() % 100) < hit_percent));
+        if (l->is_hit) {
+            snprintf(l->image, sizeof(l->image), "%s/emi-%04x%04x", dir, k, (rand() % images_of[k]));
+            hits++;
+        } else {
+            snprintf(l->image, sizeof(l->image), "%s/emi-%04x%04x", dir, k, images_of[k]++);
+            errors += (bench_make_image(l->image, l->size_mb) != EUCA_OK);
+            images++;
+        }
+    }
+    bench_launches_len = launches;
+    bench_next = 0;
+
+    snprintf(config, sizeof(config), "launches=%d concurrency=%d sizes=%s hit_percent=%d hits=%d images=%d sshkey=%s",
+             launches, concurrency, sizes_opt, hit_percent, hits, images, (bench_sshkey ? "yes" : "no"));
+    printf("replaying %s\n", config);
+    fflush(stdout);                    // or the helpers forked during the run would print it again
+
+    if (errors == 0) {
+        started = mono_time_usec();
+        for (int i = 0; i < concurrency; i++)
+            pthread_create(&threads[i], NULL, bench_worker, &(thread_errors[i]));
+        for (int i = 0; i < concurrency; i++) {
+            pthread_join(threads[i], NULL);
+            errors += thread_errors[i];
+        }
+        bench_report(out, config, (mono_time_usec() - started));
+    }
+
+    for (int n = 0; n < launches; n++) {
+        if (!bench_launches[n].is_hit)
+            unlink(bench_launches[n].image);
+    }
+    rmdir(dir);
+    EUCA_FREE(bench_launches);
+    if (out != stdout)
+        fclose(out);
+    return (errors);
+}
+#endif /* _BENCHMARK */
+
 //!
 //! Main entry point of the application
 //!
@@ -3373,6 +4917,20 @@ int main(int argc, char **argv)
         euca_srand();                  // seed the random number generator
         blobstore_set_error_function(dummy_err_fn);
 
+#ifdef _BENCHMARK
+        logfile(NULL, EUCA_LOG_WARN, 4);   // tracing every artifact would dominate the timings
+        cache_bs = create_teststore(BS_SIZE, cwd, "cache", BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_ANY);
+        work_bs = create_teststore(BS_SIZE, cwd, "work", BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_NONE, BLOBSTORE_SNAPSHOT_ANY);
+        if (cache_bs == NULL || work_bs == NULL) {
+            printf("error: failed to create blobstores\n");
+            exit(1);
+        }
+        errors = do_benchmark(cwd, argc, argv);
+        blobstore_delete_regex(work_bs, ".*");
+        blobstore_delete_regex(cache_bs, ".*");
+        exit(errors);
+#endif /* _BENCHMARK */
+
         printf("testing vbr.c\n");
 
         cache_bs = create_teststore(BS_SIZE, cwd, "cache", BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_ANY);
@@ -91,6 +91,7 @@
 #define MAX_ARTIFACT_DEPS                            16
 #define MAX_ARTIFACT_SIG                         262144
 #define MAX_SSHKEY_SIZE                          262144
+#define MAX_ARTIFACT_CONTENT_KEY                    128
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -116,6 +117,7 @@ typedef struct _artifact {
     boolean id_is_path;                //!< if set, id is a PATH
 
     char sig[MAX_ARTIFACT_SIG];        //!< unique signature for the artifact (IGNORED for a sentinel)
+    char content_key[MAX_ARTIFACT_CONTENT_KEY]; //!< OPTIONAL key derived from the content, under which artifacts with different IDs share a cached blob
     boolean may_be_cached;             //!< the underlying blob may reside in cache (it will not be modified by an instance)
     boolean is_in_cache;               //!< indicates if the artifact is known to reside in cache (value only valid after artifact allocation)
     boolean must_be_file;              //!< the bits for this artifact must reside in a regular file (rather than just on a block device)
@@ -160,6 +162,12 @@ host_config localhost_config;
 \*----------------------------------------------------------------------------*/
 int vbr_init_hostconfig(char *hostIqn, char *hostIp, char *ws_sec_policy_file, int use_ws_sec, boolean use_virtio_root, boolean use_virtio_disk);
 int vbr_update_hostconfig_scurl(char *new_sc_url);
+int vbr_set_digest_cache_ttl(int ttl_sec);
+int vbr_set_download_streams(int streams);
+int vbr_set_image_peers(const char *peers, int port, const char *publish_dir);
+boolean vbr_set_lazy_boot(boolean enable);
+boolean vbr_set_compressed_cache(boolean enable);
+void vbr_set_fast_cache(blobstore * bs);
 int get_localhost_sc_url(char *dest);
 
 int vbr_add_ascii(const char *spec_str, virtualMachine * vm_type);
@@ -179,6 +187,7 @@ artifact *art_alloc(const char *id, const char *sig, long long size_bytes, boole
 void art_set_instanceId(const char *instanceId);
 artifact *vbr_alloc_tree(virtualMachine * vm, boolean do_make_bootable, boolean do_make_work_copy, boolean is_migration_dest, const char *sshkey, boolean * bail_flag,
                          const char *instanceId);
+artifact *vbr_alloc_image_tree(virtualBootRecord * vbr, boolean * bail_flag, const char *instanceId);
 int art_implement_tree(artifact * root, blobstore * work_bs, blobstore * cache_bs, const char *work_prefix, long long timeout_usec);
 
 /*----------------------------------------------------------------------------*\
@@ -76,8 +76,13 @@ $LOGIN_TIMEOUT = 12;
 $LOGOUT_TIMEOUT = 5;
 $LOGIN_RETRY_COUNT = 1;
 
+$REUSE_SESSION = "reuse";
+
 # check input params
 $dev_string = untaint(shift @ARGV);
+
+#2nd param is a hint from the NC about the sessions of the target
+$session_hint = untaint(shift @ARGV);
 ($euca_home, $volume_id, $target_device, $target_serial, $target_bus, $ceph_user, $ceph_keyring, $ceph_conf, $protocol, $provider, $user, $auth_mode, $lun, $encrypted_password, @paths) = parse_devstring($dev_string);
 
 if (is_null_or_empty($euca_home)) {
@@ -253,10 +258,11 @@ if (!is_null_or_empty($protocol) && $protocol eq $PROTOCOL_RBD) {
     $store = shift(@paths);
     # get netdev from iface name using eucalyptus.conf
     $netdev = get_netdev_by_conf($conf_iface);
-    # lun based, check if session exists and refresh session
-    if (($lun > -1) && (retry_until_true(\&check_session_exists, [$netdev, $ip, $store], 5) == 1)) {
-      # rescan session
-      run_cmd(1, 1, "$ISCSIADM -m session -R");
+    # lun based, check if session exists and only scan for the new lun over it.
+    # The NC tells when it has other volumes behind the target, so one lookup is enough.
+    $session_checks = ($session_hint eq $REUSE_SESSION) ? 1 : 5;
+    if (($lun > -1) && (retry_until_true(\&check_session_exists, [$netdev, $ip, $store], $session_checks) == 1)) {
+      scan_lun($netdev, $ip, $store, $lun);
     } else {
       # prepare password for login target 
       if ($password ne $NOT_REQUIRED) {
@@ -292,7 +298,12 @@ if (!is_null_or_empty($protocol) && $protocol eq $PROTOCOL_RBD) {
   if ($multipath == 0) {
     $localdev = $devices[0];
   } else {
-    $localdev = retry_until_exists(\&get_mpath_device, \@devices, 5);
+    $localdev = get_mpath_device(@devices);
+    if (is_null_or_empty($localdev)) {
+      # set up the map of the new lun now rather than waiting for multipathd to pick its paths up
+      run_cmd(1, 0, "$MULTIPATH /dev/$devices[0]");
+      $localdev = retry_until_exists(\&get_mpath_device, \@devices, 5);
+    }
   }
   if (is_null_or_empty($localdev)) {
     print STDERR "Unable to get attached target device.\n";
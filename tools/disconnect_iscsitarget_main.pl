@@ -64,6 +64,7 @@ delete @ENV{qw(IFS CDPATH ENV BASH_ENV)};
 $ENV{'PATH'}='/bin:/usr/bin:/sbin:/usr/sbin/';
 
 $YES_RESCAN = "rescan";
+$KEEP_SESSION = "keepsession";
 
 $CONF_IFACES_KEY = "STORAGE_INTERFACES";
 
@@ -72,6 +73,9 @@ $dev_string = untaint(shift @ARGV);
 
 #2nd param is if a rescan should be done or not
 $do_rescan = untaint(shift @ARGV);
+
+#3rd param is a hint from the NC about the sessions of the target
+$session_hint = untaint(shift @ARGV);
 ($euca_home, $volume_id, $target_device, $target_serial, $target_bus, $ceph_user, $ceph_keyring, $ceph_conf, $protocol, $provider, $user, $auth_mode, $lun, $encrypted_password, @paths) = parse_devstring($dev_string);
 
 if (is_null_or_empty($euca_home)) {
@@ -137,8 +141,8 @@ if (!is_null_or_empty($protocol) && $protocol eq $PROTOCOL_RBD) {
         delete_lun($netdev, $ip, $store, $lun);
       
         if($do_rescan eq $YES_RESCAN) {
-      	  # rescan target
-      	  run_cmd(1, 1, "$ISCSIADM -m session -R");
+      	  # rescan the session of the target
+      	  rescan_session($netdev, $ip, $store);
       	  last if is_null_or_empty(get_iscsi_device($netdev, $ip, $store, $lun));
       	  sleep(5);
         } else {
@@ -147,6 +151,8 @@ if (!is_null_or_empty($protocol) && $protocol eq $PROTOCOL_RBD) {
         }
       }
       print STDERR "Tried deleting lun $lun $i times in iSCSI session IP=$ip, IQN=$store\n";
+      # other volumes of the NC are still connected over this session
+      next if $session_hint eq $KEEP_SESSION;
       next if retry_until_true(\&has_device_attached, [$netdev, $ip, $store], 5) == 1;
     }
     # logout
@@ -205,6 +205,41 @@ sub rescan_all_sessions {
   run_cmd(1, 1, "$ISCSIADM -m session -R");
 }
 
+sub find_iscsi_session {
+  my ($netdev, $ip, $store) = @_;
+  for $session (lookup_session()) {
+    if (match_iscsi_session($session, $netdev, $ip, $store)) {
+      return $session;
+    }
+  }
+}
+
+sub rescan_session {
+  my ($netdev, $ip, $store) = @_;
+  my $session = find_iscsi_session($netdev, $ip, $store);
+  if (is_null_or_empty($session->{$SK_SID})) {
+    rescan_all_sessions();
+  } else {
+    run_cmd(1, 1, "$ISCSIADM -m session -r $session->{$SK_SID} -R");
+  }
+}
+
+sub scan_lun {
+  # scan only for the given lun of the session rather than all luns of all sessions
+  my ($netdev, $ip, $store, $lun) = @_;
+  my $session = find_iscsi_session($netdev, $ip, $store);
+  my $host_number = $session->{$SK_HOSTNUMBER};
+  if (!is_null_or_empty($host_number)) {
+    my $scan_path = "/sys/class/scsi_host/host$host_number/scan";
+    if (open SCANLUN, ">$scan_path") {
+      print SCANLUN "0 0 $lun";
+      return if close SCANLUN;
+    }
+    print STDERR "Unable to scan lun $lun through $scan_path.\n";
+  }
+  rescan_session($netdev, $ip, $store);
+}
+
 
 sub get_first_lun {
   foreach (@_) {
@@ -152,8 +152,20 @@ that describes a Eucalyptus instance to be launched.
             <on_reboot>restart</on_reboot>
             <on_crash>destroy</on_crash>
             <vcpu>
+                <!-- keep the virtual CPUs of an instance pinned to a NUMA node on the CPUs of that node -->
+                <xsl:if test="(/instance/hypervisor/@type = 'kvm' or /instance/hypervisor/@type = 'qemu') and /instance/numa">
+                    <xsl:attribute name="placement">static</xsl:attribute>
+                    <xsl:attribute name="cpuset">
+                        <xsl:value-of select="/instance/numa/@cpus"/>
+                    </xsl:attribute>
+                </xsl:if>
                 <xsl:value-of select="/instance/cores"/>
             </vcpu>
+            <xsl:if test="(/instance/hypervisor/@type = 'kvm' or /instance/hypervisor/@type = 'qemu') and /instance/virtioTuning/@ioThreads &gt; 0">
+                <iothreads>
+                    <xsl:value-of select="/instance/virtioTuning/@ioThreads"/>
+                </iothreads>
+            </xsl:if>
             <cpu>
               <topology>
                 <xsl:attribute name="sockets">
@@ -170,6 +182,34 @@ that describes a Eucalyptus instance to be launched.
             <memory>
                 <xsl:value-of select="/instance/memoryKB"/>
             </memory>
+            <xsl:if test="(/instance/hypervisor/@type = 'kvm' or /instance/hypervisor/@type = 'qemu') and /instance/numa">
+                <cputune>
+                    <emulatorpin>
+                        <xsl:attribute name="cpuset">
+                            <xsl:value-of select="/instance/numa/@cpus"/>
+                        </xsl:attribute>
+                    </emulatorpin>
+                </cputune>
+                <numatune>
+                    <memory mode="strict">
+                        <xsl:attribute name="nodeset">
+                            <xsl:value-of select="/instance/numa/@node"/>
+                        </xsl:attribute>
+                    </memory>
+                </numatune>
+            </xsl:if>
+            <!-- the huge pages come from the pinned node through numatune -->
+            <xsl:if test="(/instance/hypervisor/@type = 'kvm' or /instance/hypervisor/@type = 'qemu') and /instance/hugePagesKB">
+                <memoryBacking>
+                    <hugepages>
+                        <page unit="KiB">
+                            <xsl:attribute name="size">
+                                <xsl:value-of select="/instance/hugePagesKB"/>
+                            </xsl:attribute>
+                        </page>
+                    </hugepages>
+                </memoryBacking>
+            </xsl:if>
             <devices> 
                 <xsl:if test="/instance/hypervisor/@type = 'xen' and ( /instance/os/@platform = 'windows' or /instance/backing/root/@type = 'ebs' )">
                     <xsl:choose>
@@ -192,7 +232,24 @@ that describes a Eucalyptus instance to be launched.
                         <xsl:attribute name="type">
                             <xsl:value-of select="@sourceType"/>
                         </xsl:attribute>
-                        <driver cache="none"/>
+                        <driver cache="none">
+                            <!-- a lazily booted disk is an overlay that copies the blocks the guest reads into itself -->
+                            <xsl:if test="@format = 'qcow2'">
+                                <xsl:attribute name="type">qcow2</xsl:attribute>
+                                <xsl:attribute name="copy_on_read">on</xsl:attribute>
+                            </xsl:if>
+                            <!-- let the guest discard blocks, which the loop device punches out of the backing file -->
+                            <xsl:if test="(/instance/hypervisor/@type='kvm' or /instance/hypervisor/@type='qemu') and /instance/disks/@discard = 'true'">
+                                <xsl:attribute name="discard">unmap</xsl:attribute>
+                            </xsl:if>
+                            <!-- spread virtio disks over the I/O threads, round-robin, with native asynchronous I/O -->
+                            <xsl:if test="(/instance/hypervisor/@type='kvm' or /instance/hypervisor/@type='qemu') and ( /instance/os/@platform='windows' or /instance/os/@virtioRoot = 'true') and /instance/virtioTuning/@ioThreads &gt; 0">
+                                <xsl:attribute name="io">native</xsl:attribute>
+                                <xsl:attribute name="iothread">
+                                    <xsl:value-of select="((position() - 1) mod /instance/virtioTuning/@ioThreads) + 1"/>
+                                </xsl:attribute>
+                            </xsl:if>
+                        </driver>
                         <source>
                             <xsl:choose>
                                 <xsl:when test="@sourceType = 'file'">
@@ -242,6 +299,20 @@ that describes a Eucalyptus instance to be launched.
 			        </xsl:otherwise>
 	                    </xsl:choose>
                         </target>
+                        <xsl:if test="(/instance/hypervisor/@type='kvm' or /instance/hypervisor/@type='qemu') and (/instance/qos/@diskIops &gt; 0 or /instance/qos/@diskBytes &gt; 0)">
+                            <iotune>
+                                <xsl:if test="/instance/qos/@diskBytes &gt; 0">
+                                    <total_bytes_sec>
+                                        <xsl:value-of select="/instance/qos/@diskBytes"/>
+                                    </total_bytes_sec>
+                                </xsl:if>
+                                <xsl:if test="/instance/qos/@diskIops &gt; 0">
+                                    <total_iops_sec>
+                                        <xsl:value-of select="/instance/qos/@diskIops"/>
+                                    </total_iops_sec>
+                                </xsl:if>
+                            </iotune>
+                        </xsl:if>
                     </disk>
                 </xsl:for-each>
                 <xsl:if test="/instance/disks/floppyPath != ''">
@@ -292,6 +363,39 @@ that describes a Eucalyptus instance to be launched.
                                 <model type="e1000"/>
                             </xsl:when>
                         </xsl:choose>
+                        <!-- vhost-net with several queues and a larger receive ring for virtio cards -->
+                        <xsl:if test="(/instance/hypervisor/@type='kvm' or /instance/hypervisor/@type = 'qemu') and ( /instance/os/@platform = 'windows' or /instance/os/@virtioNetwork = 'true' ) and /instance/virtioTuning">
+                            <driver name="vhost">
+                                <xsl:if test="/instance/virtioTuning/@netQueues &gt; 1">
+                                    <xsl:attribute name="queues">
+                                        <xsl:value-of select="/instance/virtioTuning/@netQueues"/>
+                                    </xsl:attribute>
+                                </xsl:if>
+                                <xsl:if test="/instance/virtioTuning/@netRingSize &gt; 0">
+                                    <xsl:attribute name="rx_queue_size">
+                                        <xsl:value-of select="/instance/virtioTuning/@netRingSize"/>
+                                    </xsl:attribute>
+                                </xsl:if>
+                            </driver>
+                        </xsl:if>
+                        <xsl:if test="(/instance/hypervisor/@type='kvm' or /instance/hypervisor/@type='qemu') and (/instance/qos/@netInbound &gt; 0 or /instance/qos/@netOutbound &gt; 0)">
+                            <bandwidth>
+                                <xsl:if test="/instance/qos/@netInbound &gt; 0">
+                                    <inbound>
+                                        <xsl:attribute name="average">
+                                            <xsl:value-of select="/instance/qos/@netInbound"/>
+                                        </xsl:attribute>
+                                    </inbound>
+                                </xsl:if>
+                                <xsl:if test="/instance/qos/@netOutbound &gt; 0">
+                                    <outbound>
+                                        <xsl:attribute name="average">
+                                            <xsl:value-of select="/instance/qos/@netOutbound"/>
+                                        </xsl:attribute>
+                                    </outbound>
+                                </xsl:if>
+                            </bandwidth>
+                        </xsl:if>
                         <xsl:if test="/instance/hypervisor/@type = 'xen'">
                             <script path="/etc/xen/scripts/vif-bridge"/>
                         </xsl:if>
@@ -323,6 +427,15 @@ that describes a Eucalyptus instance to be launched.
                     <console type="pty"/>
                 </xsl:when>
 	</xsl:choose>
+                <xsl:if test="(/instance/hypervisor/@type = 'kvm' or /instance/hypervisor/@type = 'qemu') and /instance/balloonStatsPeriod &gt; 0">
+                    <memballoon model="virtio">
+                        <stats>
+                            <xsl:attribute name="period">
+                                <xsl:value-of select="/instance/balloonStatsPeriod"/>
+                            </xsl:attribute>
+                        </stats>
+                    </memballoon>
+                </xsl:if>
                 <!-- <graphics type='vnc' port='-1' autoport='yes' keymap='en-us' -->
             </devices>
         </domain>
@@ -386,6 +499,20 @@ that describes a Eucalyptus instance to be launched.
             <xsl:value-of select="/volume/diskPath/@serial"/>
           </serial>
         </xsl:if>
+        <xsl:if test="(/volume/hypervisor/@type='kvm' or /volume/hypervisor/@type='qemu') and (/volume/qos/@diskIops &gt; 0 or /volume/qos/@diskBytes &gt; 0)">
+            <iotune>
+                <xsl:if test="/volume/qos/@diskBytes &gt; 0">
+                    <total_bytes_sec>
+                        <xsl:value-of select="/volume/qos/@diskBytes"/>
+                    </total_bytes_sec>
+                </xsl:if>
+                <xsl:if test="/volume/qos/@diskIops &gt; 0">
+                    <total_iops_sec>
+                        <xsl:value-of select="/volume/qos/@diskIops"/>
+                    </total_iops_sec>
+                </xsl:if>
+            </iotune>
+        </xsl:if>
       </disk>
     </xsl:template>
 
@@ -77,11 +77,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 
 #include <log.h>
 #include <http.h>
 #include <hash.h>
+#include <euca_file.h>
+#include <euca_string.h>
 #include "atomic_file.h"
 
 /*----------------------------------------------------------------------------*\
@@ -134,6 +139,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int atomic_file_mktemp(atomic_file * file);
+static int atomic_file_fetch_http(atomic_file * file, http_validator * validator, char *rawhash, int rawhash_size);
+static int atomic_file_fetch_file(atomic_file * file, const char *path, struct stat *sourcestat, char *rawhash, int rawhash_size);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -182,25 +191,21 @@ int atomic_file_init(atomic_file * file, char *source, char *dest, int dosort)
 }
 
 //!
-//! Function description.
-//!
-//! @param[in] file
-//! @param[in] file_updated
-//!
-//! @return
-//!
-//! @see
+//! Fetches the source into the destination, and tells whether that changed the destination.
+//! A source that has not changed since it was last fetched is detected without reading it: an
+//! http source is fetched with a request conditional on the ETag and Last-Modified it had, and a
+//! file source is not read while its inode, size and modification time stay the same. Otherwise
+//! the MD5 of the content, computed as it is fetched, is compared with the one of the last fetch,
+//! so only new content gets sorted, hashed again and put in place.
 //!
-//! @pre List of pre-conditions
+//! @param[in]  file
+//! @param[out] file_updated set to 1 if the destination was updated, 0 otherwise
 //!
-//! @post List of post conditions
-//!
-//! @note
+//! @return 0 on success or 1 on failure
 //!
 int atomic_file_get(atomic_file * file, int *file_updated)
 {
     int port = 0;
-    int fd = 0;
     int ret = 0;
     int rc = 0;
     char *hash = NULL;
@@ -209,6 +214,9 @@ int atomic_file_get(atomic_file * file, int *file_updated)
     char path[EUCA_MAX_PATH] = "";
     char tmpsource[EUCA_MAX_PATH] = "";
     char tmppath[EUCA_MAX_PATH] = "";
+    char rawhash[HTTP_MD5_SIZE] = "";
+    http_validator validator = { {0} };
+    struct stat sourcestat = { 0 };
 
     if (!file || !file_updated) {
         return (1);
@@ -216,17 +224,14 @@ int atomic_file_get(atomic_file * file, int *file_updated)
 
     ret = 0;
     *file_updated = 0;
+    file->tmpfile[0] = '\0';
 
-    snprintf(file->tmpfile, EUCA_MAX_PATH, "%s", file->tmpfilebase);
-    fd = safe_mkstemp(file->tmpfile);
-    if (fd < 0) {
-        LOGERROR("cannot open tmpfile '%s': check permissions\n", file->tmpfile);
-        return (1);
-    }
-    if (chmod(file->tmpfile, 0600)) {
-        LOGWARN("chmod failed: was able to create tmpfile '%s', but could not change file permissions\n", file->tmpfile);
+    // without the destination in place, what was last fetched tells nothing
+    if (check_file(file->dest)) {
+        file->fetchhash[0] = '\0';
+        bzero(&(file->validator), sizeof(http_validator));
+        bzero(&(file->sourcestat), sizeof(struct stat));
     }
-    close(fd);
 
     snprintf(tmpsource, EUCA_MAX_PATH, "%s", file->source);
     type[0] = tmppath[0] = path[0] = hostname[0] = '\0';
@@ -236,55 +241,199 @@ int atomic_file_get(atomic_file * file, int *file_updated)
     snprintf(path, EUCA_MAX_PATH, "/%s", tmppath);
 
     if (!strcmp(type, "http")) {
-        rc = http_get_timeout(file->source, file->tmpfile, 0, 0, 10, 15, NULL);
-        if (rc) {
-            LOGERROR("http client failed to fetch file URL=%s: check http server status\n", file->source);
-            ret = 1;
-        }
+        validator = file->validator;
+        ret = atomic_file_fetch_http(file, &validator, rawhash, sizeof(rawhash));
     } else if (!strcmp(type, "file")) {
-        if (!strlen(path) || copy_file(path, file->tmpfile)) {
-            LOGERROR("could not copy source file (%s) to dest file (%s): check permissions\n", path, file->tmpfile);
-            ret = 1;
-        }
+        ret = atomic_file_fetch_file(file, path, &sourcestat, rawhash, sizeof(rawhash));
     } else {
         LOGWARN("BUG: incompatible URI type (%s) passed to routine (only supports http, file)\n", type);
         ret = 1;
     }
 
-    if (!ret) {
-        if (file->dosort) {
-            rc = atomic_file_sort_tmpfile(file);
-            if (rc) {
-                LOGWARN("could not sort tmpfile (%s) inplace: continuing without sort\n", file->tmpfile);
-            }
-        }
-        // do checksum - only copy if file has changed
-        hash = file2md5str(file->tmpfile);
-        if (!hash) {
-            LOGERROR("could not compute hash of tmpfile (%s): check permissions\n", file->tmpfile);
-            ret = 1;
+    if (!ret && rawhash[0]) {
+        if (!strcmp(rawhash, file->fetchhash)) {
+            LOGDEBUG("source (%s) has the same content as when it was last fetched, not updating dest (%s)\n", file->source, file->dest);
         } else {
-            if (file->currhash)
-                EUCA_FREE(file->currhash);
-            file->currhash = hash;
-            if (check_file(file->dest) || strcmp(file->currhash, file->lasthash)) {
-                // hashes are different, put new file in place
-                LOGINFO("update triggered due to file update (%s)\n", file->dest);
-                LOGDEBUG("source and destination file contents have become different, triggering update of dest (%s)\n", file->dest);
-                LOGDEBUG("renaming file %s -> %s\n", file->tmpfile, file->dest);
-                if (rename(file->tmpfile, file->dest)) {
-                    LOGERROR("could not rename (move) source file '%s' to dest file '%s': check permissions\n", file->tmpfile, file->dest);
-                    ret = 1;
-                } else {
-                    EUCA_FREE(file->lasthash);
-                    file->lasthash = strdup(file->currhash);
-                    *file_updated = 1;
+            if (file->dosort) {
+                rc = atomic_file_sort_tmpfile(file);
+                if (rc) {
+                    LOGWARN("could not sort tmpfile (%s) inplace: continuing without sort\n", file->tmpfile);
                 }
+                hash = file2md5str(file->tmpfile);
+            } else {
+                hash = strdup(rawhash);
+            }
+
+            // do checksum - only copy if file has changed
+            if (!hash) {
+                LOGERROR("could not compute hash of tmpfile (%s): check permissions\n", file->tmpfile);
+                ret = 1;
+            } else {
+                if (file->currhash)
+                    EUCA_FREE(file->currhash);
+                file->currhash = hash;
+                if (check_file(file->dest) || strcmp(file->currhash, file->lasthash)) {
+                    // hashes are different, put new file in place
+                    LOGINFO("update triggered due to file update (%s)\n", file->dest);
+                    LOGDEBUG("source and destination file contents have become different, triggering update of dest (%s)\n", file->dest);
+                    LOGDEBUG("renaming file %s -> %s\n", file->tmpfile, file->dest);
+                    if (rename(file->tmpfile, file->dest)) {
+                        LOGERROR("could not rename (move) source file '%s' to dest file '%s': check permissions\n", file->tmpfile, file->dest);
+                        ret = 1;
+                    } else {
+                        EUCA_FREE(file->lasthash);
+                        file->lasthash = strdup(file->currhash);
+                        *file_updated = 1;
+                    }
+                }
+            }
+        }
+    }
+    // only remember what was fetched once the destination matches it
+    if (!ret && rawhash[0]) {
+        euca_strncpy(file->fetchhash, rawhash, sizeof(file->fetchhash));
+        file->validator = validator;
+        file->sourcestat = sourcestat;
+    }
+
+    if (file->tmpfile[0])
+        unlink(file->tmpfile);
+    return (ret);
+}
+
+//!
+//! Creates the temporary file a fetch writes to, named after the destination
+//!
+//! @param[in] file
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int atomic_file_mktemp(atomic_file * file)
+{
+    int fd = 0;
+
+    snprintf(file->tmpfile, EUCA_MAX_PATH, "%s", file->tmpfilebase);
+    fd = safe_mkstemp(file->tmpfile);
+    if (fd < 0) {
+        LOGERROR("cannot open tmpfile '%s': check permissions\n", file->tmpfile);
+        file->tmpfile[0] = '\0';
+        return (1);
+    }
+    if (chmod(file->tmpfile, 0600)) {
+        LOGWARN("chmod failed: was able to create tmpfile '%s', but could not change file permissions\n", file->tmpfile);
+    }
+    close(fd);
+    return (0);
+}
+
+//!
+//! Downloads an http source into the temporary file, unless the server says it has not changed
+//!
+//! @param[in]     file
+//! @param[in,out] validator what is known about the last download, updated for this one
+//! @param[out]    rawhash set to the hex MD5 of the downloaded content, or to "" if the source has not changed
+//! @param[in]     rawhash_size
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int atomic_file_fetch_http(atomic_file * file, http_validator * validator, char *rawhash, int rawhash_size)
+{
+    rawhash[0] = '\0';
+    if (atomic_file_mktemp(file))
+        return (1);
+
+    if (http_get_timeout_validated(file->source, file->tmpfile, 0, 0, 10, 15, validator, NULL)) {
+        LOGERROR("http client failed to fetch file URL=%s: check http server status\n", file->source);
+        return (1);
+    }
+
+    if (validator->not_modified) {
+        LOGDEBUG("source (%s) has not been modified since it was last fetched\n", file->source);
+        return (0);
+    }
+
+    if (!validator->md5[0]) {
+        LOGERROR("could not compute hash of tmpfile (%s) while fetching it\n", file->tmpfile);
+        return (1);
+    }
+
+    euca_strncpy(rawhash, validator->md5, rawhash_size);
+    return (0);
+}
+
+//!
+//! Copies a file source into the temporary file. Nothing is read if the source is the file that
+//! was last fetched, and nothing is written if its content is still the same.
+//!
+//! @param[in]  file
+//! @param[in]  path the path of the source
+//! @param[out] sourcestat set to the state of the source
+//! @param[out] rawhash set to the hex MD5 of the content, or to "" if the source has not changed
+//! @param[in]  rawhash_size
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int atomic_file_fetch_file(atomic_file * file, const char *path, struct stat *sourcestat, char *rawhash, int rawhash_size)
+{
+    int fd = -1;
+    int ret = 0;
+    size_t done = 0;
+    ssize_t wrote = 0;
+    file_view view = { 0 };
+
+    rawhash[0] = '\0';
+    if (!strlen(path) || stat(path, sourcestat)) {
+        LOGERROR("could not copy source file (%s) to dest file (%s): check permissions\n", path, file->dest);
+        return (1);
+    }
+
+    if ((sourcestat->st_ino == file->sourcestat.st_ino) && (sourcestat->st_dev == file->sourcestat.st_dev) && (sourcestat->st_size == file->sourcestat.st_size)
+        && (sourcestat->st_mtim.tv_sec == file->sourcestat.st_mtim.tv_sec) && (sourcestat->st_mtim.tv_nsec == file->sourcestat.st_mtim.tv_nsec)) {
+        LOGDEBUG("source (%s) has not been modified since it was last fetched\n", file->source);
+        return (0);
+    }
+
+    if (file_view_open(path, -1, &view) != EUCA_OK) {
+        LOGERROR("could not copy source file (%s) to dest file (%s): check permissions\n", path, file->dest);
+        return (1);
+    }
+
+    if (mem2md5str(rawhash, rawhash_size, view.data, view.len) != EUCA_OK) {
+        LOGERROR("could not compute hash of source file (%s)\n", path);
+        file_view_close(&view);
+        return (1);
+    }
+    // the same content as last time needs no copy, atomic_file_get() will not use it
+    if (!strcmp(rawhash, file->fetchhash)) {
+        file_view_close(&view);
+        return (0);
+    }
+
+    if (atomic_file_mktemp(file)) {
+        file_view_close(&view);
+        return (1);
+    }
+
+    if ((fd = open(file->tmpfile, O_WRONLY | O_TRUNC)) < 0) {
+        ret = 1;
+    } else {
+        while (done < view.len) {
+            if ((wrote = write(fd, (view.data + done), (view.len - done))) < 0) {
+                if (errno == EINTR)
+                    continue;
+                ret = 1;
+                break;
             }
+            done += wrote;
         }
+        if (close(fd))
+            ret = 1;
     }
 
-    unlink(file->tmpfile);
+    if (ret) {
+        LOGERROR("could not copy source file (%s) to dest file (%s): check permissions\n", path, file->tmpfile);
+    }
+    file_view_close(&view);
     return (ret);
 }
 
@@ -77,6 +77,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <sys/stat.h>
+#include <http.h>
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -108,6 +111,9 @@ typedef struct atomic_file_t {
     char source[EUCA_MAX_PATH];
     char *lasthash, *currhash;
     int dosort;
+    char fetchhash[HTTP_MD5_SIZE];     //!< hex MD5 of the source as it was last fetched, before any sort
+    http_validator validator;          //!< what the last http fetch learned about the source, to make the next one conditional
+    struct stat sourcestat;            //!< state of a file source when it was last fetched, to not read it again unchanged
 } atomic_file;
 
 /*----------------------------------------------------------------------------*\
@@ -0,0 +1,1289 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/bench_strings.c
+//! Microbenchmarks and equivalence fuzzing of the string, XML and URL helpers on request paths
+//!
+//! The benchmarks time xpath_content(), xpath_extract(), euca_strreplace(), euca_tokenizer(), c_varsub() and
+//! its compiled form, url_encode(), url_decode() and process_url() on representative inputs (large user-data,
+//! long URL queries, deep and wide XML) and report the nanoseconds, heap allocations and
+//! allocated bytes per call. Allocations are counted by interposing malloc(), calloc() and
+//! realloc(), so those made inside libc, e.g., by strdup() or regexec(), are included.
+//!
+//! The fuzz harness feeds the same functions random inputs and compares their results with
+//! straightforward reference implementations of their current behavior, quirks included,
+//! so that an optimized rewrite can be checked for equivalence before it replaces the
+//! original. Where the current behavior on malformed input is an accident rather than a
+//! contract (url_decode() of bad escapes), only the absence of crashes is checked.
+//!
+//! Every result line starts with 'strings_bench' or 'strings_fuzz' and only holds key=value
+//! pairs. The exit code is the number of mismatches found.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "eucalyptus.h"
+#include "misc.h"
+#include "log.h"
+#include "euca_string.h"
+#include "euca_auth.h"
+#include "wc.h"
+#include <http.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define BENCH_TARGET_MS                           200   //!< Default time spent benchmarking each case
+#define BENCH_BATCH                                64   //!< Calls timed together, after their inputs are prepared
+#define BENCH_TOKENS                             1000   //!< Tokens in the euca_tokenizer() list
+#define BENCH_USERDATA_BYTES                    32768   //!< Size of the euca_strreplace() user-data
+#define BENCH_QUERY_BYTES                        8192   //!< Size of the URL queries
+#define BENCH_XML_DEPTH                            60   //!< Depth of the deep XML, the XML cursor stacks up to 64 tags
+#define BENCH_XML_SIBLINGS                       2000   //!< Elements in the wide XML
+
+#define FUZZ_ROUNDS                              2000   //!< Default number of random inputs per function
+#define FUZZ_REPORTED                               3   //!< Mismatches printed in full per function
+#define FUZZ_MAX_TOKENS                            32   //!< Largest token array given to euca_tokenizer()
+#define STRREPLACE_MAX_LEN                      65535   //!< Longest result of euca_strreplace(), see MAX_BUFFER_SIZE there
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! One benchmark case
+typedef struct benchCase_t {
+    const char *op;                    //!< name of the function
+    const char *input;                 //!< short description of the input
+    void (*prepare) (struct benchCase_t * bc, int slot);    //!< readies the input of one call, untimed, may be NULL
+    void (*call) (struct benchCase_t * bc, int slot);   //!< makes one call, timed
+    const char *text;                  //!< the input
+    const char *arg;                   //!< second argument of the call, if any
+    const void *vars;                  //!< variable map, for c_varsub()
+    int component;                     //!< URL component, for process_url()
+    const char_template *tmpl;         //!< compiled text, for c_varsub_render()
+    const char_map_index *index;       //!< hashed variable map, for c_varsub_render_index()
+    char *slots[BENCH_BATCH];          //!< inputs consumed by the calls, filled by prepare()
+} benchCase;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! @{
+//! @name Allocation counters, only updated while alloc_counting is set
+static int alloc_counting = 0;
+static long long alloc_count = 0;
+static long long alloc_bytes = 0;
+//! @}
+
+static unsigned int fuzz_seed = 1;     //!< rand_r() state of the fuzz harness
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static long long bench_nsec(void);
+static void bench_run(FILE * out, benchCase * bc, long long target_ms);
+static void bench_copy_text(benchCase * bc, int slot);
+static void call_xpath_content(benchCase * bc, int slot);
+static void call_xpath_extract(benchCase * bc, int slot);
+static void call_strreplace(benchCase * bc, int slot);
+static void call_tokenizer(benchCase * bc, int slot);
+static void call_c_varsub(benchCase * bc, int slot);
+static void call_c_varsub_render(benchCase * bc, int slot);
+static void call_url_encode(benchCase * bc, int slot);
+static void call_url_decode(benchCase * bc, int slot);
+static void call_process_url(benchCase * bc, int slot);
+static char *build_deep_xml(int depth, char *xpath, int xpath_len);
+static char *build_wide_xml(int siblings, char *xpath, int xpath_len);
+static char *build_userdata(int bytes, const char *marker);
+static char *build_query(int bytes);
+static int benchmarks(FILE * out, long long target_ms);
+
+static int fuzz_rand(int n);
+static char *fuzz_string(const char *alphabet, int len);
+static void fuzz_mismatch(const char *op, int *mismatches, const char *input, const char *expected, const char *actual);
+static char *ref_strreplace(const char *haystack, const char *search, const char *value);
+static int ref_tokenizer(const char *list, const char *delim, char *tokens[], int nbTokens);
+static char *ref_c_varsub(const char *s, char **keys, char **vals, int nvars);
+static char *ref_url_encode(const char *unencoded);
+static char *ref_url_decode(const char *encoded);
+static int fuzz_strreplace(FILE * out, int rounds);
+static int fuzz_tokenizer(FILE * out, int rounds);
+static int fuzz_c_varsub(FILE * out, int rounds);
+static int fuzz_url(FILE * out, int rounds);
+static int fuzz_process_url(FILE * out, int rounds);
+static int fuzz_xpath_content(FILE * out, int rounds);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Counting malloc(), on top of the libc one
+//!
+//! @param[in] size
+//!
+//! @return the memory or NULL
+//!
+void *malloc(size_t size)
+{
+    if (alloc_counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return (__libc_malloc(size));
+}
+
+//!
+//! Counting calloc(), on top of the libc one
+//!
+//! @param[in] nmemb
+//! @param[in] size
+//!
+//! @return the memory or NULL
+//!
+void *calloc(size_t nmemb, size_t size)
+{
+    if (alloc_counting) {
+        alloc_count++;
+        alloc_bytes += (nmemb * size);
+    }
+    return (__libc_calloc(nmemb, size));
+}
+
+//!
+//! Counting realloc(), on top of the libc one. A reallocation counts as an allocation of
+//! the new size, as it may well move the memory.
+//!
+//! @param[in] ptr
+//! @param[in] size
+//!
+//! @return the memory or NULL
+//!
+void *realloc(void *ptr, size_t size)
+{
+    if (alloc_counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return (__libc_realloc(ptr, size));
+}
+
+//!
+//! Nanoseconds on the monotonic clock
+//!
+//! @return the current time in nanoseconds
+//!
+static long long bench_nsec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec) * 1000000000LL + ts.tv_nsec);
+}
+
+//!
+//! Times batches of calls of a case until target_ms have been spent in them and prints the
+//! result line. The inputs of a batch are prepared before it is timed, with allocation
+//! counting off.
+//!
+//! @param[in] out stream to print to
+//! @param[in] bc the case
+//! @param[in] target_ms time to spend in the calls
+//!
+static void bench_run(FILE * out, benchCase * bc, long long target_ms)
+{
+    int i = 0;
+    long long calls = 0;
+    long long start = 0;
+    long long elapsed = 0;
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+    while (elapsed < (target_ms * 1000000LL)) {
+        if (bc->prepare) {
+            for (i = 0; i < BENCH_BATCH; i++)
+                bc->prepare(bc, i);
+        }
+
+        alloc_counting = 1;
+        start = bench_nsec();
+        for (i = 0; i < BENCH_BATCH; i++)
+            bc->call(bc, i);
+        elapsed += bench_nsec() - start;
+        alloc_counting = 0;
+        calls += BENCH_BATCH;
+    }
+
+    fprintf(out, "strings_bench op=%s input=%s input_bytes=%zu calls=%lld ns_per_op=%.1f allocs_per_op=%.2f bytes_per_op=%.1f\n", bc->op, bc->input,
+            strlen(bc->text), calls, ((double)elapsed / calls), ((double)alloc_count / calls), ((double)alloc_bytes / calls));
+    fflush(out);
+}
+
+//!
+//! Gives a call its own copy of the input, for functions that consume theirs
+//!
+//! @param[in] bc the case
+//! @param[in] slot the call
+//!
+static void bench_copy_text(benchCase * bc, int slot)
+{
+    bc->slots[slot] = strdup(bc->text);
+}
+
+//!
+//! Times xpath_content(), the case argument being the xpath
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_xpath_content(benchCase * bc, int slot)
+{
+    char *res = xpath_content(bc->text, bc->arg);
+    EUCA_FREE(res);
+}
+
+//!
+//! Times xpath_extract(), which finds the same content as xpath_content() without copying it
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_xpath_extract(benchCase * bc, int slot)
+{
+    const char *xpath = bc->arg;
+    xml_slice slice = { 0 };
+
+    xpath_extract(bc->text, &xpath, 1, &slice);
+}
+
+//!
+//! Times euca_strreplace() of every marker of the user-data, the case argument being the marker
+//!
+//! @param[in] bc the case
+//! @param[in] slot the call, whose copy of the user-data is consumed
+//!
+static void call_strreplace(benchCase * bc, int slot)
+{
+    euca_strreplace(&(bc->slots[slot]), ((char *)bc->arg), "i-0123ABCD");
+    EUCA_FREE(bc->slots[slot]);
+}
+
+//!
+//! Times euca_tokenizer() and the release of the tokens, as callers do, the case argument
+//! being the delimiters
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_tokenizer(benchCase * bc, int slot)
+{
+    int i = 0;
+    int count = 0;
+    char *tokens[BENCH_TOKENS + 1] = { NULL };
+
+    count = euca_tokenizer(((char *)bc->text), ((char *)bc->arg), tokens, (BENCH_TOKENS + 1));
+    for (i = 0; i < count; i++)
+        EUCA_FREE(tokens[i]);
+}
+
+//!
+//! Times c_varsub() with the map of the case
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_c_varsub(benchCase * bc, int slot)
+{
+    char *res = c_varsub(bc->text, ((const char_map **)bc->vars));
+    EUCA_FREE(res);
+}
+
+//!
+//! Times c_varsub_render_index() of the compiled text of the case if it has a hashed map,
+//! c_varsub_render() otherwise
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_c_varsub_render(benchCase * bc, int slot)
+{
+    char *res = ((bc->index) ? c_varsub_render_index(bc->tmpl, bc->index) : c_varsub_render(bc->tmpl, ((const char_map **)bc->vars)));
+    EUCA_FREE(res);
+}
+
+//!
+//! Times url_encode()
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_url_encode(benchCase * bc, int slot)
+{
+    char *res = url_encode(bc->text);
+    EUCA_FREE(res);
+}
+
+//!
+//! Times url_decode()
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_url_decode(benchCase * bc, int slot)
+{
+    char *res = url_decode(bc->text);
+    EUCA_FREE(res);
+}
+
+//!
+//! Times process_url() for the URL component of the case
+//!
+//! @param[in] bc the case
+//! @param[in] slot unused
+//!
+static void call_process_url(benchCase * bc, int slot)
+{
+    char *res = process_url(bc->text, bc->component);
+    EUCA_FREE(res);
+}
+
+//!
+//! Builds an XML document nested 'depth' elements deep, with a sibling and an attribute at
+//! every level, and the xpath of its innermost element
+//!
+//! @param[in]  depth number of nested elements
+//! @param[out] xpath buffer receiving the xpath of the innermost element
+//! @param[in]  xpath_len size of the xpath buffer
+//!
+//! @return the document, to be freed by the caller
+//!
+static char *build_deep_xml(int depth, char *xpath, int xpath_len)
+{
+    int i = 0;
+    size_t len = 0;
+    size_t size = (depth * 96) + 64;
+    char *xml = EUCA_ZALLOC(size, sizeof(char));
+
+    xpath[0] = '\0';
+    for (i = 0; i < depth; i++) {
+        len += snprintf(xml + len, size - len, "<level%d index=\"%d\"><note%d/><sibling%d>s</sibling%d>", i, i, i, i, i);
+        euca_strncat(xpath, ((i > 0) ? "/" : ""), xpath_len);
+        snprintf(xpath + strlen(xpath), xpath_len - strlen(xpath), "level%d", i);
+    }
+    len += snprintf(xml + len, size - len, "innermost");
+    for (i = depth - 1; i >= 0; i--) {
+        len += snprintf(xml + len, size - len, "</level%d>", i);
+    }
+    return (xml);
+}
+
+//!
+//! Builds an instance-like XML document with 'siblings' volume elements and the xpath of
+//! the last one's device
+//!
+//! @param[in]  siblings number of volume elements
+//! @param[out] xpath buffer receiving the xpath
+//! @param[in]  xpath_len size of the xpath buffer
+//!
+//! @return the document, to be freed by the caller
+//!
+static char *build_wide_xml(int siblings, char *xpath, int xpath_len)
+{
+    int i = 0;
+    size_t len = 0;
+    size_t size = (siblings * 128) + 256;
+    char *xml = EUCA_ZALLOC(size, sizeof(char));
+
+    len += snprintf(xml + len, size - len, "<?xml version=\"1.0\"?><instance><name>i-0123ABCD</name><volumes>");
+    for (i = 0; i < siblings; i++) {
+        len += snprintf(xml + len, size - len, "<volume><id>vol-%08X</id><state>attached</state></volume>", i);
+    }
+    len += snprintf(xml + len, size - len, "</volumes><last><device>/dev/vdz</device></last></instance>");
+    snprintf(xpath, xpath_len, "instance/last/device");
+    return (xml);
+}
+
+//!
+//! Builds a user-data like text of about 'bytes' bytes, with the marker every 128 bytes
+//!
+//! @param[in] bytes size of the text
+//! @param[in] marker the string to scatter in the text
+//!
+//! @return the text, to be freed by the caller
+//!
+static char *build_userdata(int bytes, const char *marker)
+{
+    int i = 0;
+    size_t len = 0;
+    char *text = EUCA_ZALLOC(bytes + 128, sizeof(char));
+    const char *b64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    while (len < (size_t) bytes) {
+        if (((len % 128) == 0) && (marker[0] != '\0')) {
+            len += snprintf(text + len, bytes + 128 - len, "%s", marker);
+        } else {
+            text[len++] = b64[(i++ * 7) % 64];
+            if ((len % 77) == 0)
+                text[len++] = '\n';
+        }
+    }
+    text[bytes] = '\0';
+    return (text);
+}
+
+//!
+//! Builds a signed request URL with a long query string of about 'bytes' bytes, holding
+//! characters to escape
+//!
+//! @param[in] bytes size of the query string
+//!
+//! @return the URL, to be freed by the caller
+//!
+static char *build_query(int bytes)
+{
+    int i = 0;
+    size_t len = 0;
+    char *url = EUCA_ZALLOC(bytes + 256, sizeof(char));
+
+    len = snprintf(url, bytes + 256, "http://objectstorage.example.com:8773/services/objectstorage/bucket/image.part.0?");
+    for (i = 0; len < (size_t) bytes; i++) {
+        len += snprintf(url + len, bytes + 256 - len, "X-Param-%d=some value/with:reserved&chars%%%d&", i, (i % 100));
+    }
+    url[bytes] = '\0';
+    return (url);
+}
+
+//!
+//! Runs all benchmark cases
+//!
+//! @param[in] out stream to print to
+//! @param[in] target_ms time to spend on each case
+//!
+//! @return the number of cases that could not be set up
+//!
+static int benchmarks(FILE * out, long long target_ms)
+{
+    int i = 0;
+    int errors = 0;
+    char deep_xpath[EUCA_MAX_PATH] = "";
+    char wide_xpath[EUCA_MAX_PATH] = "";
+    char *deep_xml = build_deep_xml(BENCH_XML_DEPTH, deep_xpath, sizeof(deep_xpath));
+    char *wide_xml = build_wide_xml(BENCH_XML_SIBLINGS, wide_xpath, sizeof(wide_xpath));
+    char *userdata = build_userdata(BENCH_USERDATA_BYTES, "${instance-id}");
+    char *plaindata = build_userdata(BENCH_USERDATA_BYTES, "");
+    char *query = build_query(BENCH_QUERY_BYTES);
+    char *encoded = url_encode(query);
+    char *tokens = EUCA_ZALLOC(BENCH_TOKENS * 16, sizeof(char));
+    char *template = EUCA_ZALLOC(BENCH_USERDATA_BYTES + 256, sizeof(char));
+    char_map **vars = NULL;
+    char_template *compiled = NULL;
+    char_map_index *index = NULL;
+
+    for (i = 0; i < BENCH_TOKENS; i++) {
+        snprintf(tokens + strlen(tokens), 16, "%svol-%08X", ((i > 0) ? ", " : ""), i);
+    }
+
+    // a libvirt-like template, as the NC and fault messages substitute
+    vars = c_varmap_alloc(vars, "instanceId", "i-0123ABCD");
+    vars = c_varmap_alloc(vars, "kernel", "/var/lib/eucalyptus/instances/work/kernel");
+    vars = c_varmap_alloc(vars, "ramdisk", "/var/lib/eucalyptus/instances/work/ramdisk");
+    vars = c_varmap_alloc(vars, "memory", "524288");
+    vars = c_varmap_alloc(vars, "cores", "2");
+    vars = c_varmap_alloc(vars, "bridge", "br0");
+    while (strlen(template) < BENCH_USERDATA_BYTES) {
+        strcat(template, "<disk type='file'><source file='${kernel}'/><target dev='${instanceId}'/></disk>"
+               "<memory>${memory}</memory><vcpu>${cores}</vcpu><interface><source bridge='${bridge}'/></interface>\n");
+    }
+    compiled = c_varsub_compile(template);
+    index = c_varmap_index((const char_map **)vars);
+
+    {
+        benchCase cases[] = {
+            {"xpath_content", "deep_xml", NULL, call_xpath_content, deep_xml, deep_xpath},
+            {"xpath_content", "wide_xml", NULL, call_xpath_content, wide_xml, wide_xpath},
+            {"xpath_extract", "deep_xml", NULL, call_xpath_extract, deep_xml, deep_xpath},
+            {"xpath_extract", "wide_xml", NULL, call_xpath_extract, wide_xml, wide_xpath},
+            {"euca_strreplace", "userdata_markers", bench_copy_text, call_strreplace, userdata, "${instance-id}"},
+            {"euca_strreplace", "userdata_plain", bench_copy_text, call_strreplace, plaindata, "${instance-id}"},
+            {"euca_tokenizer", "volume_list", NULL, call_tokenizer, tokens, ", "},
+            {"c_varsub", "libvirt_template", NULL, call_c_varsub, template, NULL, vars},
+            {"c_varsub", "userdata_plain", NULL, call_c_varsub, plaindata, NULL, vars},
+            {"c_varsub_render", "libvirt_template", NULL, call_c_varsub_render, template, NULL, vars, 0, compiled},
+            {"c_varsub_render_index", "libvirt_template", NULL, call_c_varsub_render, template, NULL, vars, 0, compiled, index},
+            {"url_encode", "long_query", NULL, call_url_encode, query},
+            {"url_decode", "long_query", NULL, call_url_decode, encoded},
+            {"process_url", "protocol", NULL, call_process_url, query, NULL, NULL, URL_PROTOCOL},
+            {"process_url", "hostname", NULL, call_process_url, query, NULL, NULL, URL_HOSTNAME},
+            {"process_url", "port", NULL, call_process_url, query, NULL, NULL, URL_PORT},
+            {"process_url", "path", NULL, call_process_url, query, NULL, NULL, URL_PATH},
+            {"process_url", "query", NULL, call_process_url, query, NULL, NULL, URL_QUERY},
+        };
+
+        if (!deep_xml || !wide_xml || !userdata || !plaindata || !query || !encoded || !tokens || !template || !vars || !compiled || !index) {
+            fprintf(stderr, "ERROR: out of memory for the benchmark inputs\n");
+            errors++;
+        } else {
+            for (i = 0; i < (sizeof(cases) / sizeof(cases[0])); i++)
+                bench_run(out, &(cases[i]), target_ms);
+        }
+    }
+
+    c_varmap_index_free(index);
+    c_varsub_free(compiled);
+    c_varmap_free(vars);
+    EUCA_FREE(template);
+    EUCA_FREE(tokens);
+    EUCA_FREE(encoded);
+    EUCA_FREE(query);
+    EUCA_FREE(plaindata);
+    EUCA_FREE(userdata);
+    EUCA_FREE(wide_xml);
+    EUCA_FREE(deep_xml);
+    return (errors);
+}
+
+//!
+//! Random number for the fuzz harness
+//!
+//! @param[in] n bound
+//!
+//! @return a random number from 0 to n - 1
+//!
+static int fuzz_rand(int n)
+{
+    return ((n > 0) ? (rand_r(&fuzz_seed) % n) : 0);
+}
+
+//!
+//! Random string of characters of an alphabet
+//!
+//! @param[in] alphabet the characters to use
+//! @param[in] len length of the string
+//!
+//! @return the string, to be freed by the caller
+//!
+static char *fuzz_string(const char *alphabet, int len)
+{
+    int i = 0;
+    int n = strlen(alphabet);
+    char *s = EUCA_ZALLOC(len + 1, sizeof(char));
+
+    for (i = 0; (s != NULL) && (i < len); i++)
+        s[i] = alphabet[fuzz_rand(n)];
+    return (s);
+}
+
+//!
+//! Counts a mismatch and prints the first FUZZ_REPORTED ones of a function in full
+//!
+//! @param[in]     op name of the function
+//! @param[in,out] mismatches mismatch counter of the function
+//! @param[in]     input description of the input
+//! @param[in]     expected result of the reference implementation
+//! @param[in]     actual result of the function
+//!
+static void fuzz_mismatch(const char *op, int *mismatches, const char *input, const char *expected, const char *actual)
+{
+    if ((*mismatches)++ < FUZZ_REPORTED) {
+        fprintf(stderr, "MISMATCH %s input=[%.512s] expected=[%.512s] actual=[%.512s]\n", op, SP(input), (expected ? expected : "(null)"),
+                (actual ? actual : "(null)"));
+    }
+}
+
+//!
+//! Reference euca_strreplace(): every occurence of 'search', left to right and without
+//! overlaps, replaced with 'value', and the result cut at STRREPLACE_MAX_LEN characters
+//!
+//! @param[in] haystack
+//! @param[in] search
+//! @param[in] value
+//!
+//! @return the new string, to be freed by the caller
+//!
+static char *ref_strreplace(const char *haystack, const char *search, const char *value)
+{
+    int count = 0;
+    size_t len = 0;
+    char *res = NULL;
+    const char *p = NULL;
+    const char *hit = NULL;
+
+    for (p = haystack; (hit = strstr(p, search)) != NULL; p = hit + strlen(search))
+        count++;
+    if ((res = EUCA_ZALLOC(strlen(haystack) + (count * strlen(value)) + 1, sizeof(char))) == NULL)
+        return (NULL);
+
+    for (p = haystack; (hit = strstr(p, search)) != NULL; p = hit + strlen(search)) {
+        memcpy(res + len, p, (hit - p));
+        len += hit - p;
+        memcpy(res + len, value, strlen(value));
+        len += strlen(value);
+    }
+    strcpy(res + len, p);
+    if (strlen(res) > STRREPLACE_MAX_LEN)
+        res[STRREPLACE_MAX_LEN] = '\0';
+    return (res);
+}
+
+//!
+//! Reference euca_tokenizer(): the first nbTokens runs of characters that are not in 'delim'
+//!
+//! @param[in]  list
+//! @param[in]  delim
+//! @param[out] tokens receives the tokens, to be freed by the caller
+//! @param[in]  nbTokens
+//!
+//! @return the number of tokens
+//!
+static int ref_tokenizer(const char *list, const char *delim, char *tokens[], int nbTokens)
+{
+    int count = 0;
+    size_t len = 0;
+    const char *p = list;
+
+    while (*p && (count < nbTokens)) {
+        p += strspn(p, delim);
+        if ((len = strcspn(p, delim)) > 0)
+            tokens[count++] = strndup(p, len);
+        p += len;
+    }
+    return (count);
+}
+
+//!
+//! Reference c_varsub(), with its current quirks:
+//!     \li a variable matches the first key whose first name_len characters are the name;
+//!     \li unknown variables are kept as they are;
+//!     \li "${}" is dropped along with the text since the previous variable;
+//!     \li a "${" with no "}" after it, or with at most one character after it, ends the
+//!         substitution and is kept as it is;
+//!     \li an empty result is returned as NULL.
+//!
+//! @param[in] s
+//! @param[in] keys
+//! @param[in] vals
+//! @param[in] nvars
+//!
+//! @return the new string, to be freed by the caller, or NULL
+//!
+static char *ref_c_varsub(const char *s, char **keys, char **vals, int nvars)
+{
+    int i = 0;
+    size_t len = 0;
+    char *res = NULL;
+    const char *val = NULL;
+    const char *rem = s;
+    const char *start = NULL;
+    const char *end = NULL;
+
+    // substituted values are never longer than the longest value times the number of variables
+    for (i = 0, len = 0; i < nvars; i++)
+        len = MAX(len, strlen(vals[i]));
+    if ((res = EUCA_ZALLOC(strlen(s) * (len + 1) + 1, sizeof(char))) == NULL)
+        return (NULL);
+
+    while ((start = strstr(rem, "${")) != NULL) {
+        if ((strlen(start) <= 3) || ((end = strstr(start + 2, "}")) == NULL))
+            break;
+
+        if ((len = (end - start - 2)) < 1) {
+            rem = end + 1;
+            continue;
+        }
+
+        for (i = 0, val = NULL; (i < nvars) && (val == NULL); i++) {
+            if (!strncmp(keys[i], start + 2, len))
+                val = vals[i];
+        }
+        strncat(res, rem, (start - rem));
+        if (val) {
+            strcat(res, val);
+        } else {
+            strncat(res, start, (len + 3));
+        }
+        rem = end + 1;
+    }
+    strcat(res, rem);
+
+    if (res[0] == '\0')
+        EUCA_FREE(res);
+    return (res);
+}
+
+//!
+//! Reference url_encode(): ASCII letters, digits and "-_.~" as they are, spaces as '+' and
+//! every other byte as %XX, in upper case
+//!
+//! @param[in] unencoded
+//!
+//! @return the new string, to be freed by the caller
+//!
+static char *ref_url_encode(const char *unencoded)
+{
+    size_t len = 0;
+    char *res = EUCA_ZALLOC((strlen(unencoded) * 3) + 1, sizeof(char));
+    const unsigned char *p = NULL;
+
+    for (p = ((const unsigned char *)unencoded); res && *p; p++) {
+        if (((*p >= 'a') && (*p <= 'z')) || ((*p >= 'A') && (*p <= 'Z')) || ((*p >= '0') && (*p <= '9')) || strchr("-_.~", *p)) {
+            res[len++] = *p;
+        } else if (*p == ' ') {
+            res[len++] = '+';
+        } else {
+            len += sprintf(res + len, "%%%02X", *p);
+        }
+    }
+    return (res);
+}
+
+//!
+//! Reference url_decode() of well formed input: %XX as the byte, in either case, and '+' as
+//! a space
+//!
+//! @param[in] encoded
+//!
+//! @return the new string, to be freed by the caller
+//!
+static char *ref_url_decode(const char *encoded)
+{
+    size_t len = 0;
+    unsigned int byte = 0;
+    char *res = EUCA_ZALLOC(strlen(encoded) + 1, sizeof(char));
+    const char *p = NULL;
+
+    for (p = encoded; res && *p; p++) {
+        if ((*p == '%') && (sscanf(p + 1, "%2x", &byte) == 1)) {
+            res[len++] = ((char)byte);
+            p += 2;
+        } else {
+            res[len++] = ((*p == '+') ? ' ' : *p);
+        }
+    }
+    return (res);
+}
+
+//!
+//! Compares euca_strreplace() with its reference on random haystacks from a small alphabet,
+//! so that matches are frequent, some long enough for the result to be cut
+//!
+//! @param[in] out stream to print the result line to
+//! @param[in] rounds number of random inputs
+//!
+//! @return the number of mismatches
+//!
+static int fuzz_strreplace(FILE * out, int rounds)
+{
+    int r = 0;
+    int mismatches = 0;
+    char *haystack = NULL;
+    char *search = NULL;
+    char *value = NULL;
+    char *copy = NULL;
+    char *expected = NULL;
+    char *actual = NULL;
+
+    for (r = 0; r < rounds; r++) {
+        haystack = fuzz_string("ab${}\n", ((fuzz_rand(50) == 0) ? (30000 + fuzz_rand(10000)) : fuzz_rand(200)));
+        search = fuzz_string("ab$", (1 + fuzz_rand(3)));
+        value = fuzz_string("AB$", fuzz_rand(6));
+        expected = ref_strreplace(haystack, search, value);
+        copy = strdup(haystack);
+        actual = euca_strreplace(&copy, search, value);
+        if (!expected || !actual || strcmp(expected, actual))
+            fuzz_mismatch("euca_strreplace", &mismatches, haystack, expected, actual);
+        EUCA_FREE(copy);               // 'actual' is the new copy
+        EUCA_FREE(expected);
+        EUCA_FREE(value);
+        EUCA_FREE(search);
+        EUCA_FREE(haystack);
+    }
+    fprintf(out, "strings_fuzz op=euca_strreplace cases=%d mismatches=%d\n", rounds, mismatches);
+    return (mismatches);
+}
+
+//!
+//! Compares euca_tokenizer() with its reference on random lists, delimiters and sizes
+//!
+//! @param[in] out stream to print the result line to
+//! @param[in] rounds number of random inputs
+//!
+//! @return the number of mismatches
+//!
+static int fuzz_tokenizer(FILE * out, int rounds)
+{
+    int i = 0;
+    int r = 0;
+    int size = 0;
+    int count = 0;
+    int ref_count = 0;
+    int mismatches = 0;
+    char *list = NULL;
+    char *delim = NULL;
+    char *tokens[FUZZ_MAX_TOKENS] = { NULL };
+    char *ref_tokens[FUZZ_MAX_TOKENS] = { NULL };
+    char expected[32] = "";
+    char actual[32] = "";
+
+    for (r = 0; r < rounds; r++) {
+        list = fuzz_string("ab,; \t", fuzz_rand(120));
+        delim = fuzz_string(",; ", (1 + fuzz_rand(3)));
+        size = 1 + fuzz_rand(FUZZ_MAX_TOKENS);
+        count = euca_tokenizer(list, delim, tokens, size);
+        ref_count = ref_tokenizer(list, delim, ref_tokens, size);
+        if (count != ref_count) {
+            snprintf(expected, sizeof(expected), "%d tokens", ref_count);
+            snprintf(actual, sizeof(actual), "%d tokens", count);
+            fuzz_mismatch("euca_tokenizer", &mismatches, list, expected, actual);
+        } else {
+            for (i = 0; i < count; i++) {
+                if (strcmp(tokens[i], ref_tokens[i])) {
+                    fuzz_mismatch("euca_tokenizer", &mismatches, list, ref_tokens[i], tokens[i]);
+                    break;
+                }
+            }
+        }
+        for (i = 0; i < MAX(0, count); i++)
+            EUCA_FREE(tokens[i]);
+        for (i = 0; i < ref_count; i++)
+            EUCA_FREE(ref_tokens[i]);
+        EUCA_FREE(delim);
+        EUCA_FREE(list);
+    }
+    fprintf(out, "strings_fuzz op=euca_tokenizer cases=%d mismatches=%d\n", rounds, mismatches);
+    return (mismatches);
+}
+
+//!
+//! Compares c_varsub(), and the rendering of the compiled template from the map and from its
+//! hashed index, with the reference on random templates made of variables, known or not,
+//! malformed ones and text, with keys that are prefixes of one another
+//!
+//! @param[in] out stream to print the result line to
+//! @param[in] rounds number of random inputs
+//!
+//! @return the number of mismatches
+//!
+static int fuzz_c_varsub(FILE * out, int rounds)
+{
+    int i = 0;
+    int r = 0;
+    int mismatches = 0;
+    char *keys[] = { "ab", "a", "abc", "x" };
+    char *vals[] = { "AB", "", "ABC$", "${x}" };
+    char *pieces[] = { "${a}", "${ab}", "${abc}", "${x}", "${zz}", "${}", "${", "}", "a", "b", " ", "$", "{" };
+    char *tmpl = NULL;
+    char *expected = NULL;
+    char *actual = NULL;
+    char *rendered = NULL;
+    char *indexed = NULL;
+    char_map **vars = NULL;
+    char_map_index *index = NULL;
+    char_template *t = NULL;
+
+    for (i = 0; i < (sizeof(keys) / sizeof(keys[0])); i++)
+        vars = c_varmap_alloc(vars, keys[i], vals[i]);
+    index = c_varmap_index((const char_map **)vars);
+
+    for (r = 0; r < rounds; r++) {
+        if ((tmpl = EUCA_ZALLOC(256, sizeof(char))) == NULL)
+            break;
+        for (i = fuzz_rand(30); i > 0; i--)
+            strcat(tmpl, pieces[fuzz_rand(sizeof(pieces) / sizeof(pieces[0]))]);
+
+        expected = ref_c_varsub(tmpl, keys, vals, (sizeof(keys) / sizeof(keys[0])));
+        actual = c_varsub(tmpl, ((const char_map **)vars));
+        if ((!expected != !actual) || (expected && strcmp(expected, actual)))
+            fuzz_mismatch("c_varsub", &mismatches, tmpl, expected, actual);
+
+        t = c_varsub_compile(tmpl);
+        rendered = c_varsub_render(t, ((const char_map **)vars));
+        indexed = c_varsub_render_index(t, index);
+        if ((!expected != !rendered) || (expected && strcmp(expected, rendered)))
+            fuzz_mismatch("c_varsub_render", &mismatches, tmpl, expected, rendered);
+        if ((!expected != !indexed) || (expected && strcmp(expected, indexed)))
+            fuzz_mismatch("c_varsub_render_index", &mismatches, tmpl, expected, indexed);
+        c_varsub_free(t);
+        EUCA_FREE(indexed);
+        EUCA_FREE(rendered);
+        EUCA_FREE(actual);
+        EUCA_FREE(expected);
+        EUCA_FREE(tmpl);
+    }
+    c_varmap_index_free(index);
+    c_varmap_free(vars);
+    fprintf(out, "strings_fuzz op=c_varsub cases=%d mismatches=%d\n", rounds, mismatches);
+    return (mismatches);
+}
+
+//!
+//! Compares url_encode() with its reference on random bytes and checks that url_decode()
+//! undoes it; compares url_decode() with its reference on random well formed input, in
+//! either case; and feeds url_decode() malformed escapes, checking only that it returns
+//!
+//! @param[in] out stream to print the result line to
+//! @param[in] rounds number of random inputs
+//!
+//! @return the number of mismatches
+//!
+static int fuzz_url(FILE * out, int rounds)
+{
+    int i = 0;
+    int r = 0;
+    int len = 0;
+    int mismatches = 0;
+    char raw[256] = "";
+    char *encoded = NULL;
+    char *expected = NULL;
+    char *decoded = NULL;
+    char *wellformed = NULL;
+    char *malformed = NULL;
+
+    for (r = 0; r < rounds; r++) {
+        len = fuzz_rand(sizeof(raw));
+        for (i = 0; i < len; i++)
+            raw[i] = ((char)(1 + fuzz_rand(255)));
+        raw[len] = '\0';
+
+        encoded = url_encode(raw);
+        expected = ref_url_encode(raw);
+        if (!encoded || !expected || strcmp(encoded, expected))
+            fuzz_mismatch("url_encode", &mismatches, raw, expected, encoded);
+        if (encoded && ((decoded = url_decode(encoded)) != NULL) && strcmp(decoded, raw))
+            fuzz_mismatch("url_decode", &mismatches, encoded, raw, decoded);
+        EUCA_FREE(decoded);
+        EUCA_FREE(expected);
+        EUCA_FREE(encoded);
+
+        wellformed = fuzz_string("%%%%+abcXYZ09-._~", fuzz_rand(100));
+        for (i = 0; wellformed && wellformed[i]; i++) {
+            if (wellformed[i] == '%') {
+                if (wellformed[i + 1] && wellformed[i + 2]) {
+                    wellformed[i + 1] = "0123456789abcdefABCDEF"[fuzz_rand(22)];
+                    wellformed[i + 2] = "0123456789abcdefABCDEF"[fuzz_rand(22)];
+                    i += 2;
+                } else {
+                    wellformed[i] = '+';
+                }
+            }
+        }
+        // %00 would end the decoded string early in one implementation and not the other
+        for (i = 0; wellformed && wellformed[i]; i++) {
+            if ((wellformed[i] == '%') && (wellformed[i + 1] == '0') && (wellformed[i + 2] == '0'))
+                wellformed[i + 2] = '1';
+        }
+        decoded = url_decode(wellformed);
+        expected = ref_url_decode(wellformed);
+        if (!expected || !decoded || strcmp(decoded, expected))
+            fuzz_mismatch("url_decode", &mismatches, wellformed, expected, decoded);
+        EUCA_FREE(expected);
+        EUCA_FREE(decoded);
+        EUCA_FREE(wellformed);
+
+        malformed = fuzz_string("%%%%+zZ9", fuzz_rand(20));
+        if ((decoded = url_decode(malformed)) == NULL)
+            fuzz_mismatch("url_decode", &mismatches, malformed, "(a string)", NULL);
+        EUCA_FREE(decoded);
+        EUCA_FREE(malformed);
+    }
+    fprintf(out, "strings_fuzz op=url_encode,url_decode cases=%d mismatches=%d\n", rounds, mismatches);
+    return (mismatches);
+}
+
+//!
+//! Builds random URLs from known protocol, host, port, path and query parts and checks
+//! that process_url() returns each of them
+//!
+//! @param[in] out stream to print the result line to
+//! @param[in] rounds number of random inputs
+//!
+//! @return the number of mismatches
+//!
+static int fuzz_process_url(FILE * out, int rounds)
+{
+    int c = 0;
+    int r = 0;
+    int mismatches = 0;
+    int components[] = { URL_PROTOCOL, URL_HOSTNAME, URL_PORT, URL_PATH, URL_QUERY };
+    char *parts[5] = { NULL };
+    char *actual = NULL;
+    char url[1024] = "";
+
+    for (r = 0; r < rounds; r++) {
+        parts[0] = fuzz_string("abcdefghijklmnopqrstuvwxyz", (1 + fuzz_rand(6)));
+        parts[1] = fuzz_string("abcdefghijklmnopqrstuvwxyz0123456789.-", (1 + fuzz_rand(30)));
+        parts[2] = fuzz_string("0123456789", (fuzz_rand(2) ? (1 + fuzz_rand(5)) : 0));
+        parts[3] = fuzz_string("abcXYZ019/._-~%+", (fuzz_rand(2) ? fuzz_rand(60) : 0));
+        parts[4] = fuzz_string("abcXYZ019/._-~%+=&?:", (fuzz_rand(2) ? fuzz_rand(200) : 0));
+        if (parts[3][0])
+            parts[3][0] = '/';
+
+        snprintf(url, sizeof(url), "%s://%s%s%s%s%s%s", parts[0], parts[1], (parts[2][0] ? ":" : ""), parts[2], parts[3], (parts[4][0] ? "?" : ""), parts[4]);
+        for (c = 0; c < 5; c++) {
+            actual = process_url(url, components[c]);
+            if (c == 0) {
+                if (!actual || strncmp(actual, parts[0], strlen(parts[0])) || strcmp(actual + strlen(parts[0]), "://"))
+                    fuzz_mismatch("process_url", &mismatches, url, parts[0], actual);
+            } else if (!actual || strcmp(actual, parts[c])) {
+                fuzz_mismatch("process_url", &mismatches, url, parts[c], actual);
+            }
+            EUCA_FREE(actual);
+        }
+        for (c = 0; c < 5; c++)
+            EUCA_FREE(parts[c]);
+    }
+    fprintf(out, "strings_fuzz op=process_url cases=%d mismatches=%d\n", rounds, mismatches);
+    return (mismatches);
+}
+
+//!
+//! Builds random XML trees, up to BENCH_XML_DEPTH deep, with siblings, attributes and
+//! single tags along the way, and checks that xpath_content() finds the content of the
+//! element at the bottom of a random branch
+//!
+//! @param[in] out stream to print the result line to
+//! @param[in] rounds number of random inputs
+//!
+//! @return the number of mismatches
+//!
+static int fuzz_xpath_content(FILE * out, int rounds)
+{
+    int i = 0;
+    int r = 0;
+    int depth = 0;
+    int mismatches = 0;
+    size_t len = 0;
+    size_t size = (BENCH_XML_DEPTH * 256) + 256;
+    char *xml = NULL;
+    char *content = NULL;
+    char *actual = NULL;
+    char xpath[EUCA_MAX_PATH] = "";
+
+    for (r = 0; r < rounds; r++) {
+        if ((xml = EUCA_ZALLOC(size, sizeof(char))) == NULL)
+            break;
+        depth = 1 + fuzz_rand(BENCH_XML_DEPTH);
+        content = fuzz_string("abc XYZ 019 .-_", fuzz_rand(40));
+        xpath[0] = '\0';
+        len = 0;
+        for (i = 0; i < depth; i++) {
+            if (fuzz_rand(2))
+                len += snprintf(xml + len, size - len, "<Before%d>b</Before%d>", i, i);
+            if (fuzz_rand(3) == 0)
+                len += snprintf(xml + len, size - len, "<single%d/>", i);
+            len += snprintf(xml + len, size - len, (fuzz_rand(2) ? "<Node%d>" : "<Node%d attr=\"v\">"), i);
+            snprintf(xpath + strlen(xpath), sizeof(xpath) - strlen(xpath), "%snode%d", ((i > 0) ? "/" : ""), i);
+        }
+        len += snprintf(xml + len, size - len, "%s", content);
+        for (i = depth - 1; i >= 0; i--) {
+            len += snprintf(xml + len, size - len, "</Node%d>", i);
+            if (fuzz_rand(2))
+                len += snprintf(xml + len, size - len, "<After%d>a</After%d>", i, i);
+        }
+
+        actual = xpath_content(xml, xpath);
+        if (!actual || strcmp(actual, content))
+            fuzz_mismatch("xpath_content", &mismatches, xml, content, actual);
+        EUCA_FREE(actual);
+        EUCA_FREE(content);
+        EUCA_FREE(xml);
+    }
+    fprintf(out, "strings_fuzz op=xpath_content cases=%d mismatches=%d\n", rounds, mismatches);
+    return (mismatches);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of mismatches found by the fuzz harness
+//!
+int main(int argc, char **argv)
+{
+    int ch = 0;
+    int rounds = FUZZ_ROUNDS;
+    int errors = 0;
+    int do_bench = 1;
+    int do_fuzz = 1;
+    long long target_ms = BENCH_TARGET_MS;
+    FILE *out = stdout;
+
+    while ((ch = getopt(argc, argv, "bft:n:s:o:")) != -1) {
+        switch (ch) {
+        case 'b':
+            do_fuzz = 0;
+            break;
+        case 'f':
+            do_bench = 0;
+            break;
+        case 't':
+            target_ms = atoll(optarg);
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 's':
+            fuzz_seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            printf("Usage: bench_strings [-b | -f] [-t ms-per-case] [-n fuzz-rounds] [-s fuzz-seed] [-o file]\n"
+                   "  -b runs the benchmarks only, -f the fuzz harness only\n");
+            return (1);
+        }
+    }
+    if ((target_ms < 1) || (rounds < 0)) {
+        printf("ERROR: the time per case must be positive and the number of rounds must not be negative\n");
+        return (1);
+    }
+
+    // unknown variables are logged as warnings, which would be timed along with c_varsub()
+    logfile(NULL, EUCA_LOG_ERROR, 4);
+
+    if (do_fuzz) {
+        fprintf(out, "strings_fuzz seed=%u rounds=%d\n", fuzz_seed, rounds);
+        errors += fuzz_strreplace(out, rounds);
+        errors += fuzz_tokenizer(out, rounds);
+        errors += fuzz_c_varsub(out, rounds);
+        errors += fuzz_url(out, rounds);
+        errors += fuzz_process_url(out, rounds);
+        errors += fuzz_xpath_content(out, rounds);
+    }
+
+    if (do_bench && benchmarks(out, target_ms)) {
+        errors++;
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return (errors);
+}
@@ -67,6 +67,10 @@
 //! @file util/config.c
 //! Need to provide description
 //!
+//! The configuration files are parsed in one pass into a snapshot of all their KEY=value
+//! pairs, which lookups then hash into. The directories of the files are watched through
+//! inotify, so that isConfigModified() only has to look at pending events.
+//!
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -76,15 +80,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
 #include <sys/errno.h>
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "eucalyptus.h"
 #include "misc.h"
+#include "euca_string.h"
+#include "hashtable.h"
 #include "config.h"
 
 /*----------------------------------------------------------------------------*\
@@ -93,6 +104,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define MAX_CONFIG_FILES                           4    //!< most configuration files that can be watched, as lastConfigMtime[]
+#define MAX_CONFIG_CALLBACKS                       8    //!< most change callbacks that can be registered
+#define CONFIG_LINE_LEN                        32768    //!< longest configuration line, as with get_conf_var()
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -149,6 +164,34 @@ static char *asConfigValuesNoRestart[256] = { NULL };   //!< The list of modifie
 
 //! @}
 
+//! @{
+//! @name The parsed configuration files
+
+static hashtable *configSnapshot = NULL;    //!< Every KEY=value of the files last read, with the values as strings to free
+static hashtable *configKeyIndex = NULL;    //!< Index of each key in the restart (positive) or no-restart (negative) lists, plus one
+static pthread_rwlock_t configLock = PTHREAD_RWLOCK_INITIALIZER;    //!< Held for writing while the values above change
+
+//! @}
+
+//! @{
+//! @name Watches the directories of the configuration files
+
+static int configInotifyFd = -1;       //!< inotify descriptor, -1 if the files must be stat()'ed on every check
+static u32 configWatchedLen = 0;       //!< Number of files watched
+static char asConfigWatched[MAX_CONFIG_FILES][EUCA_MAX_PATH] = { "" };  //!< The files watched
+static pthread_mutex_t configWatchMutex = PTHREAD_MUTEX_INITIALIZER;   //!< Guards the watch
+
+//! @}
+
+//! @{
+//! @name The change callbacks
+
+static u32 configCallbacksLen = 0;     //!< Number of callbacks registered
+static configChangeCallback afnConfigCallbacks[MAX_CONFIG_CALLBACKS] = { NULL };  //!< The callbacks
+static void *apConfigCallbacksData[MAX_CONFIG_CALLBACKS] = { NULL };    //!< The data passed to each of them
+
+//! @}
+
 //! Hold the timestamp of when we last processed the config files
 static time_t lastConfigMtime[4] = { 0, 0, 0, 0 };
 
@@ -158,6 +201,13 @@ static time_t lastConfigMtime[4] = { 0, 0, 0, 0 };
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void free_snapshot(hashtable * snapshot);
+static int parse_config_file(const char *sPath, hashtable * snapshot);
+static hashtable *parse_config_files(char asConfigFiles[][EUCA_MAX_PATH], int numFiles);
+static char *snapshot_value(const char *sKey);
+static void watch_config_files(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles);
+static int check_config_events(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -187,9 +237,249 @@ void configInitValues(configEntry aNewConfigKeysRestart[], configEntry aNewConfi
     aConfigKeysNoRestart = aNewConfigKeysNoRestart;
 }
 
+//!
+//! Frees a snapshot and the values in it
+//!
+//! @param[in] snapshot
+//!
+static void free_snapshot(hashtable * snapshot)
+{
+    u32 pos = 0;
+    void *val = NULL;
+
+    if (snapshot != NULL) {
+        while (hashtable_next(snapshot, &pos, NULL, &val))
+            EUCA_FREE(val);
+        hashtable_free(snapshot);
+    }
+}
+
+//!
+//! Adds the KEY=value pairs of a configuration file to a snapshot, parsing each line the way
+//! get_conf_var() does. Keys already in the snapshot, from an earlier file, are left alone,
+//! and so are the keys whose first line in this file is malformed, as getConfString() would.
+//!
+//! @param[in] sPath the configuration file
+//! @param[in] snapshot
+//!
+//! @return EUCA_OK on success, EUCA_ACCESS_ERROR if the file cannot be read or EUCA_MEMORY_ERROR
+//!
+static int parse_config_file(const char *sPath, hashtable * snapshot)
+{
+    int ret = EUCA_OK;
+    FILE *f = NULL;
+    char *buf = NULL;
+    char *ptr = NULL;
+    char *key = NULL;
+    char *end = NULL;
+    char *val = NULL;
+    char *copy = NULL;
+    hashtable *seen = NULL;
+
+    if ((f = fopen(sPath, "r")) == NULL)
+        return (EUCA_ACCESS_ERROR);
+
+    if (((buf = EUCA_ALLOC(CONFIG_LINE_LEN, sizeof(char))) == NULL) || ((seen = hashtable_create(64)) == NULL)) {
+        EUCA_FREE(buf);
+        fclose(f);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    while ((ret == EUCA_OK) && fgets(buf, CONFIG_LINE_LEN, f)) {
+        // KEY, with the spaces around it removed, then an =
+        for (key = buf; ((*key != '\0') && isspace((int)*key)); key++) ;
+        if ((*key == '\0') || (*key == '=') || ((ptr = strchr(key, '=')) == NULL))
+            continue;
+        for (end = ptr; ((end > key) && isspace((int)*(end - 1))); end--) ;
+        *end = '\0';
+
+        // only the first line of a key counts in each file
+        if (hashtable_get(seen, key) != NULL)
+            continue;
+        if ((ret = hashtable_set(seen, key, seen)) != EUCA_OK)
+            break;
+
+        // then a quoted value, or the single word after the =
+        for (ptr++; (*ptr != '\0') && isspace((int)*ptr); ptr++) ;
+        if (*ptr == '"') {
+            val = ++ptr;
+            if ((ptr = strchr(ptr, '"')) == NULL)
+                continue;              // malformed, as if the key was not in this file
+            *ptr = '\0';
+            // trailing spaces are removed, as getConfString() does
+            for (end = ptr; ((end > val) && (*(end - 1) == ' ')); end--) ;
+            *end = '\0';
+        } else {
+            for (val = ptr; !isspace((int)*ptr) && (*ptr != '#') && (*ptr != '\0'); ptr++) ;
+            *ptr = '\0';
+        }
+
+        if (hashtable_get(snapshot, key) != NULL)
+            continue;
+        if ((copy = strdup(val)) == NULL) {
+            ret = EUCA_MEMORY_ERROR;
+        } else if ((ret = hashtable_set(snapshot, key, copy)) != EUCA_OK) {
+            EUCA_FREE(copy);
+        }
+    }
+
+    hashtable_free(seen);
+    EUCA_FREE(buf);
+    fclose(f);
+    return (ret);
+}
+
+//!
+//! Parses a list of configuration files into a new snapshot. Files that cannot be read are
+//! skipped, as getConfString() does.
+//!
+//! @param[in] asConfigFiles a list of configuration file path
+//! @param[in] numFiles the number of configuration files in the list
+//!
+//! @return the snapshot, to be freed with free_snapshot(), or NULL if out of memory
+//!
+static hashtable *parse_config_files(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
+{
+    int i = 0;
+    hashtable *snapshot = NULL;
+
+    if ((snapshot = hashtable_create(128)) == NULL)
+        return (NULL);
+
+    for (i = 0; i < numFiles; i++) {
+        if (parse_config_file(asConfigFiles[i], snapshot) == EUCA_MEMORY_ERROR) {
+            free_snapshot(snapshot);
+            return (NULL);
+        }
+    }
+    return (snapshot);
+}
+
+//!
+//! Copies the value of a key from the snapshot
+//!
+//! @param[in] sKey
+//!
+//! @return a copy of the value, which the caller must free, or NULL if the key is not in the snapshot
+//!
+//! @pre The caller must hold configLock.
+//!
+static char *snapshot_value(const char *sKey)
+{
+    char *val = NULL;
+
+    if ((configSnapshot != NULL) && ((val = hashtable_get(configSnapshot, sKey)) != NULL))
+        return (strdup(val));
+    return (NULL);
+}
+
+//!
+//! Watches the directories of a list of configuration files, instead of the files themselves
+//! as editors and installers replace them by renaming new files over them. If inotify is not
+//! available, isConfigModified() falls back to stat()'ing the files on every call.
+//!
+//! @param[in] asConfigFiles the list of configuration file names
+//! @param[in] numFiles the number of file names in the list
+//!
+static void watch_config_files(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles)
+{
+    u32 i = 0;
+    char sDir[EUCA_MAX_PATH] = "";
+
+    pthread_mutex_lock(&configWatchMutex);
+    {
+        if (configInotifyFd >= 0)
+            close(configInotifyFd);
+        configWatchedLen = 0;
+
+        if ((numFiles <= MAX_CONFIG_FILES) && ((configInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0)) {
+            for (i = 0; i < numFiles; i++) {
+                euca_strncpy(sDir, asConfigFiles[i], sizeof(sDir));
+                if (inotify_add_watch(configInotifyFd, dirname(sDir), (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)) < 0)
+                    break;
+                euca_strncpy(asConfigWatched[i], asConfigFiles[i], EUCA_MAX_PATH);
+            }
+
+            if (i == numFiles) {
+                configWatchedLen = numFiles;
+            } else {
+                close(configInotifyFd);
+                configInotifyFd = -1;
+            }
+        }
+
+        if (configInotifyFd < 0)
+            LOGWARN("cannot watch the configuration files, they will be checked on every call\n");
+    }
+    pthread_mutex_unlock(&configWatchMutex);
+}
+
+//!
+//! Reads the pending inotify events about the configuration files
+//!
+//! @param[in] asConfigFiles the list of configuration file names
+//! @param[in] numFiles the number of file names in the list
+//!
+//! @return 0 if none of the files changed, 1 if one may have, or -1 if the list of files is
+//!         not the one watched or cannot be watched anymore
+//!
+static int check_config_events(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles)
+{
+    u32 i = 0;
+    int rc = 0;
+    int off = 0;
+    int ret = 0;
+    char *sName = NULL;
+    char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event = NULL;
+
+    pthread_mutex_lock(&configWatchMutex);
+    {
+        if ((configInotifyFd < 0) || (numFiles != configWatchedLen)) {
+            ret = -1;
+        } else {
+            for (i = 0; (i < numFiles) && (ret == 0); i++) {
+                if (strcmp(asConfigFiles[i], asConfigWatched[i]))
+                    ret = -1;
+            }
+        }
+
+        while ((ret >= 0) && (configInotifyFd >= 0) && ((rc = read(configInotifyFd, events, sizeof(events))) > 0)) {
+            for (off = 0; off < rc; off += (sizeof(struct inotify_event) + event->len)) {
+                event = (struct inotify_event *)(events + off);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    // events were lost
+                    ret = 1;
+                    continue;
+                }
+                if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    // a directory went away, so its watch is gone: stat() until the files are read again
+                    LOGWARN("a configuration directory went away, the configuration files will be checked on every call\n");
+                    configWatchedLen = 0;
+                    ret = 1;
+                    continue;
+                }
+
+                for (i = 0; (i < numFiles) && (event->len > 0); i++) {
+                    if (((sName = strrchr(asConfigWatched[i], '/')) != NULL) ? !strcmp((sName + 1), event->name) : !strcmp(asConfigWatched[i], event->name))
+                        ret = 1;
+                }
+            }
+        }
+
+        if ((ret > 0) && (configInotifyFd >= 0) && (configWatchedLen == 0)) {
+            close(configInotifyFd);
+            configInotifyFd = -1;
+        }
+    }
+    pthread_mutex_unlock(&configWatchMutex);
+    return (ret);
+}
+
 //!
 //! Checks wether or not a given list of configuration file has been modified since we
-//! last read them.
+//! last read them. Once readConfigFile() has read the same list, this only looks at the
+//! inotify events about the files, and stat()'s them only when one of them changed.
 //!
 //! @param[in] asConfigFiles the list of configuration file names.
 //! @param[in] numFiles the number of file names in the list
@@ -208,9 +498,13 @@ int isConfigModified(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles)
 {
     u32 i = 0;
     u32 statone = 0;
+    int events = 0;
     time_t configMtime[4] = { 0, 0, 0, 0 };
     struct stat statbuf = { 0 };
 
+    if ((events = check_config_events(asConfigFiles, numFiles)) == 0)
+        return (0);
+
     for (i = 0; i < numFiles; i++) {
         // stat the config file, update modification time
         if (stat(asConfigFiles[i], &statbuf) == 0) {
@@ -243,7 +537,9 @@ int isConfigModified(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles)
             return (1);
         }
     }
-    return (0);
+
+    // a change within the same second as the last one does not show in the mtime
+    return ((events > 0) ? 1 : 0);
 }
 
 //!
@@ -264,48 +560,56 @@ int isConfigModified(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles)
 //!
 char *configFileValue(const char *sKey)
 {
-    u32 i = 0;
+    long idx = 0;
+    char *sValue = NULL;
 
     // Make sure our parameters are valid
     if (sKey != NULL) {
-        // Scan our configKeysRestart list first
-        for (i = 0; i < configRestartLen; i++) {
-            if (aConfigKeysRestart[i].key) {
-                if (!strcmp(aConfigKeysRestart[i].key, sKey)) {
-                    // Do we have a known value?
-                    if (asConfigValuesRestart[i])
-                        return (strdup(asConfigValuesRestart[i]));
-
-                    // Do we have a default value?
-                    if (aConfigKeysRestart[i].defaultValue)
-                        return (strdup(aConfigKeysRestart[i].defaultValue));
-
-                    // Doh!!
-                    return (NULL);
-                }
-            }
-        }
-
-        // Scan our configKeysNoRestart list second if not found in configKeysRestart
-        for (i = 0; i < configNoRestartLen; i++) {
-            if (aConfigKeysNoRestart[i].key) {
-                if (!strcmp(aConfigKeysNoRestart[i].key, sKey)) {
-                    // Do we have a known value?
-                    if (asConfigValuesNoRestart[i])
-                        return (strdup(asConfigValuesNoRestart[i]));
-
-                    // Do we have a default value?
-                    if (aConfigKeysNoRestart[i].defaultValue)
-                        return (strdup(aConfigKeysNoRestart[i].defaultValue));
-
-                    // Doh!!
-                    return (NULL);
-                }
+        pthread_rwlock_rdlock(&configLock);
+        {
+            if (configKeyIndex != NULL)
+                idx = (long)((intptr_t) hashtable_get(configKeyIndex, sKey));
+
+            if (idx > 0) {
+                // Use the known value, or the default value
+                if (asConfigValuesRestart[idx - 1])
+                    sValue = strdup(asConfigValuesRestart[idx - 1]);
+                else if (aConfigKeysRestart[idx - 1].defaultValue)
+                    sValue = strdup(aConfigKeysRestart[idx - 1].defaultValue);
+            } else if (idx < 0) {
+                if (asConfigValuesNoRestart[-idx - 1])
+                    sValue = strdup(asConfigValuesNoRestart[-idx - 1]);
+                else if (aConfigKeysNoRestart[-idx - 1].defaultValue)
+                    sValue = strdup(aConfigKeysNoRestart[-idx - 1].defaultValue);
             }
         }
+        pthread_rwlock_unlock(&configLock);
     }
 
-    return (NULL);
+    return (sValue);
+}
+
+//!
+//! Retrieves the value of any key of the configuration files, as of the last readConfigFile(),
+//! without reading the files again. This is what getConfString() returns for the same files,
+//! for keys that are not in the configuration key lists as well.
+//!
+//! @param[in] sKey the name of the key
+//!
+//! @return a string copy of the value or NULL if the key is not in the files
+//!
+//! @note the caller is responsible for freeing the allocated memory
+//!
+char *configSnapshotValue(const char *sKey)
+{
+    char *sValue = NULL;
+
+    if (sKey != NULL) {
+        pthread_rwlock_rdlock(&configLock);
+        sValue = snapshot_value(sKey);
+        pthread_rwlock_unlock(&configLock);
+    }
+    return (sValue);
 }
 
 //!
@@ -345,7 +649,41 @@ boolean configFileValueLong(const char *sKey, long *pVal)
 }
 
 //!
-//! Reads a list of configuration files and fill in our configuration holders
+//! Registers a function to call after readConfigFile() changes the value of a configuration
+//! key that does not require a restart. The function is called without any lock held, so it
+//! may use configFileValue().
+//!
+//! @param[in] fnCallback the function, called with the key, its new value (NULL if it was
+//!                       removed from the files) and pData
+//! @param[in] pData passed to fnCallback
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if fnCallback is NULL or EUCA_OVERFLOW_ERROR
+//!         if too many functions are registered already
+//!
+int configRegisterChangeCallback(configChangeCallback fnCallback, void *pData)
+{
+    int ret = EUCA_OK;
+
+    if (fnCallback == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    pthread_rwlock_wrlock(&configLock);
+    {
+        if (configCallbacksLen >= MAX_CONFIG_CALLBACKS) {
+            ret = EUCA_OVERFLOW_ERROR;
+        } else {
+            afnConfigCallbacks[configCallbacksLen] = fnCallback;
+            apConfigCallbacksData[configCallbacksLen] = pData;
+            configCallbacksLen++;
+        }
+    }
+    pthread_rwlock_unlock(&configLock);
+    return (ret);
+}
+
+//!
+//! Reads a list of configuration files and fill in our configuration holders. Each file is
+//! parsed once, into a snapshot that later lookups use, and is then watched for changes.
 //!
 //! @param[in] asConfigFiles a list of configuration file path
 //! @param[in] numFiles the number of configuration files in the list
@@ -359,13 +697,32 @@ boolean configFileValueLong(const char *sKey, long *pVal)
 int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
 {
     u32 i = 0;
+    u32 j = 0;
+    u32 nchanged = 0;
+    u32 ncallbacks = 0;
     int ret = 0;
     char *old = NULL;
     char *new = NULL;
+    char *asChangedKeys[256] = { NULL };
+    char *asChangedValues[256] = { NULL };
+    void *apData[MAX_CONFIG_CALLBACKS] = { NULL };
+    hashtable *snapshot = NULL;
+    configChangeCallback afnCallbacks[MAX_CONFIG_CALLBACKS] = { NULL };
+
+    // watch before reading, so that no change goes unnoticed
+    watch_config_files(asConfigFiles, numFiles);
+    if ((snapshot = parse_config_files(asConfigFiles, numFiles)) == NULL) {
+        LOGERROR("out of memory reading the configuration files\n");
+        return (0);
+    }
+
+    pthread_rwlock_wrlock(&configLock);
+    free_snapshot(configSnapshot);
+    configSnapshot = snapshot;
 
     for (i = 0; aConfigKeysRestart[i].key; i++) {
         old = asConfigValuesRestart[i];
-        new = getConfString(asConfigFiles, numFiles, aConfigKeysRestart[i].key);
+        new = snapshot_value(aConfigKeysRestart[i].key);
         if (configRestartLen) {
             if ((!old && new) || (old && !new) || ((old && new) && strcmp(old, new))) {
                 LOGWARN("configuration file changed (KEY=%s, ORIGVALUE=%s, NEWVALUE=%s): clean restart is required before this change "
@@ -384,7 +741,7 @@ int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
 
     for (i = 0; aConfigKeysNoRestart[i].key; i++) {
         old = asConfigValuesNoRestart[i];
-        new = getConfString(asConfigFiles, numFiles, aConfigKeysNoRestart[i].key);
+        new = snapshot_value(aConfigKeysNoRestart[i].key);
 
         if (configNoRestartLen) {
             if ((!old && new) || (old && !new) || ((old && new) && strcmp(old, new))) {
@@ -392,6 +749,10 @@ int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
                 ret++;
                 EUCA_FREE(asConfigValuesNoRestart[i]);
                 asConfigValuesNoRestart[i] = new;
+                if (configCallbacksLen > 0) {
+                    asChangedKeys[nchanged] = aConfigKeysNoRestart[i].key;
+                    asChangedValues[nchanged++] = ((new != NULL) ? strdup(new) : NULL);
+                }
             } else {
                 EUCA_FREE(new);
             }
@@ -404,6 +765,29 @@ int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
     }
     configNoRestartLen = i;
 
+    // the key lists do not change, so they are indexed once; restart keys come first, as they always did
+    if ((configKeyIndex == NULL) && ((configKeyIndex = hashtable_create(configRestartLen + configNoRestartLen)) != NULL)) {
+        for (i = 0; i < configRestartLen; i++) {
+            if (hashtable_get(configKeyIndex, aConfigKeysRestart[i].key) == NULL)
+                hashtable_set(configKeyIndex, aConfigKeysRestart[i].key, (void *)((intptr_t) (i + 1)));
+        }
+        for (i = 0; i < configNoRestartLen; i++) {
+            if (hashtable_get(configKeyIndex, aConfigKeysNoRestart[i].key) == NULL)
+                hashtable_set(configKeyIndex, aConfigKeysNoRestart[i].key, (void *)(-((intptr_t) (i + 1))));
+        }
+    }
+
+    ncallbacks = configCallbacksLen;
+    memcpy(afnCallbacks, afnConfigCallbacks, sizeof(afnCallbacks));
+    memcpy(apData, apConfigCallbacksData, sizeof(apData));
+    pthread_rwlock_unlock(&configLock);
+
+    for (i = 0; i < nchanged; i++) {
+        for (j = 0; j < ncallbacks; j++)
+            afnCallbacks[j] (asChangedKeys[i], asChangedValues[i], apData[j]);
+        EUCA_FREE(asChangedValues[i]);
+    }
+
     return (ret);
 }
 
@@ -445,3 +829,122 @@ void configReadLogParams(int *pLogLevel, int *pLogRollNumber, long *pLogMaxSizeB
     if (psLogPrefix)
         (*psLogPrefix) = configFileValue("LOGPREFIX");
 }
+
+#ifdef _UNIT_TEST
+//!
+//! Change callback of the unit test, which counts its calls
+//!
+//! @param[in] sKey
+//! @param[in] sNewValue
+//! @param[in] pData a pointer to the counter
+//!
+static void test_callback(const char *sKey, const char *sNewValue, void *pData)
+{
+    printf("changed %s=%s\n", sKey, SP(sNewValue));
+    (*((int *)pData))++;
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int main(int argc, char **argv)
+{
+#define CHECK(_cond)                                                     \
+{                                                                        \
+	if (!(_cond)) {                                                      \
+		printf("failed: %s at line %d\n", #_cond, __LINE__);             \
+		return (EUCA_ERROR);                                             \
+	}                                                                    \
+}
+
+    int i = 0;
+    int calls = 0;
+    char *a = NULL;
+    char *b = NULL;
+    FILE *f = NULL;
+    long long start = 0;
+    char sDir[EUCA_MAX_PATH] = "/tmp/test_config_XXXXXX";
+    char sTmp[EUCA_MAX_PATH] = "";
+    char asFiles[2][EUCA_MAX_PATH] = { "", "" };
+    const char *asKeys[] = { "LOGLEVEL", "QUOTED", "SPACED", "EMPTY", "BROKEN", "FIRST", "ONLY2", "COMMENTED", "MISSING", NULL };
+    configEntry aRestart[] = { {"FIRST", "def"}, {"MISSING", "default"}, {NULL, NULL} };
+    configEntry aNoRestart[] = { {"LOGLEVEL", "INFO"}, {"QUOTED", NULL}, {"ONLY2", NULL}, {NULL, NULL} };
+
+    CHECK(mkdtemp(sDir) != NULL);
+    snprintf(asFiles[0], EUCA_MAX_PATH, "%s/eucalyptus.conf", sDir);
+    snprintf(asFiles[1], EUCA_MAX_PATH, "%s/eucalyptus.local.conf", sDir);
+    snprintf(sTmp, EUCA_MAX_PATH, "%s/eucalyptus.conf.new", sDir);
+
+    CHECK((f = fopen(asFiles[0], "w")) != NULL);
+    fprintf(f, "# KEY=comment\nLOGLEVEL=\"DEBUG\"\n  QUOTED = \"a b=c  \"\nSPACED   =   word # comment\nEMPTY=\nBROKEN=\"open\nFIRST=one\nFIRST=two\n#COMMENTED=x\n");
+    fclose(f);
+    CHECK((f = fopen(asFiles[1], "w")) != NULL);
+    fprintf(f, "BROKEN=closed\nONLY2=\"two\"\nFIRST=other\n");
+    fclose(f);
+
+    // the snapshot must agree with getConfString() on every key
+    configInitValues(aRestart, aNoRestart);
+    CHECK(readConfigFile(asFiles, 2) == 5);
+    for (i = 0; asKeys[i] != NULL; i++) {
+        a = getConfString(asFiles, 2, (char *)asKeys[i]);
+        b = configSnapshotValue(asKeys[i]);
+        printf("%s: getConfString()='%s' configSnapshotValue()='%s'\n", asKeys[i], SP(a), SP(b));
+        CHECK(((a == NULL) && (b == NULL)) || ((a != NULL) && (b != NULL) && !strcmp(a, b)));
+        EUCA_FREE(a);
+        EUCA_FREE(b);
+    }
+    CHECK(((a = configFileValue("MISSING")) != NULL) && !strcmp(a, "default"));
+    EUCA_FREE(a);
+    CHECK(((a = configFileValue("QUOTED")) != NULL) && !strcmp(a, "a b=c"));
+    EUCA_FREE(a);
+    CHECK(configFileValue("SPACED") == NULL);
+
+    // without changes, checking costs no file access
+    isConfigModified(asFiles, 2);
+    CHECK(isConfigModified(asFiles, 2) == 0);
+    start = time_usec();
+    for (i = 0; i < 100000; i++)
+        isConfigModified(asFiles, 2);
+    printf("isConfigModified() without changes: %.3f us\n", ((double)(time_usec() - start)) / 100000);
+    start = time_usec();
+    for (i = 0; i < 100000; i++) {
+        a = configFileValue("LOGLEVEL");
+        EUCA_FREE(a);
+    }
+    printf("configFileValue(): %.3f us\n", ((double)(time_usec() - start)) / 100000);
+
+    // a file renamed over the old one, within the same second
+    CHECK(configRegisterChangeCallback(test_callback, &calls) == EUCA_OK);
+    CHECK((f = fopen(sTmp, "w")) != NULL);
+    fprintf(f, "LOGLEVEL=TRACE\nFIRST=changed\n");
+    fclose(f);
+    CHECK(rename(sTmp, asFiles[0]) == 0);
+    CHECK(isConfigModified(asFiles, 2) == 1);
+    CHECK(readConfigFile(asFiles, 2) == 2);
+    CHECK(calls == 2);                 // LOGLEVEL and QUOTED, while FIRST needs a restart
+    CHECK(((a = configFileValue("LOGLEVEL")) != NULL) && !strcmp(a, "TRACE"));
+    EUCA_FREE(a);
+    CHECK(((a = configFileValue("FIRST")) != NULL) && !strcmp(a, "one"));
+    EUCA_FREE(a);
+    CHECK(isConfigModified(asFiles, 2) == 0);
+
+    // other files in the directory do not count
+    CHECK((f = fopen(sTmp, "w")) != NULL);
+    fclose(f);
+    unlink(sTmp);
+    CHECK(isConfigModified(asFiles, 2) == 0);
+
+    unlink(asFiles[0]);
+    unlink(asFiles[1]);
+    rmdir(sDir);
+    printf("config tests passed\n");
+    return (EUCA_OK);
+
+#undef CHECK
+}
+#endif /* _UNIT_TEST */
@@ -91,6 +91,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Function called when a configuration value that does not require a restart changes
+typedef void (*configChangeCallback) (const char *sKey, const char *sNewValue, void *pData);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -124,7 +127,9 @@ typedef struct configEntry_t {
 void configInitValues(configEntry aNewConfigKeysRestart[], configEntry aNewConfigKeysNoRestart[]);
 int isConfigModified(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles);
 char *configFileValue(const char *sKey);
+char *configSnapshotValue(const char *sKey);
 boolean configFileValueLong(const char *sKey, long *pVal);
+int configRegisterChangeCallback(configChangeCallback fnCallback, void *pData);
 int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles);
 void configReadLogParams(int *pLogLevel, int *pLogRollNumber, long *pLogMaxSizeBytes, char **psLogPrefix);
 
@@ -82,6 +82,7 @@
 
 #include "data.h"
 #include "euca_string.h"
+#include "hash.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -89,12 +90,27 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define INSTANCE_INDEX_MIN_SLOTS                  32    //!< slots in the smallest index of an instance list, a power of 2
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! One slot of the index of an instance list
+typedef struct instance_index_slot_t {
+    u64 hash;                          //!< euca_hash64_str() of the instance identifier
+    bunchOfInstances *node;            //!< the list node of the instance, NULL if the slot is free
+} instance_index_slot;
+
+//! Index of the nodes of an instance list by instance identifier, open-addressed with linear probing
+typedef struct instance_index_t {
+    u32 size;                          //!< number of slots, a power of 2
+    u32 count;                         //!< number of nodes in the index
+    instance_index_slot *slots;        //!< the slots
+} instance_index;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -121,6 +137,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Slab of the instance structures, of which the NC clones one per instance on every describe
+euca_slab instance_slab = EUCA_SLAB_INITIALIZER("ncInstance", ncInstance, INSTANCE_SLAB_MAX_FREE);
+
 //! List of string to convert the hypervisor capability types enumeration
 const char *hypervisorCapabilityTypeNames[] = {
     "unknown",
@@ -285,6 +304,11 @@ const char *euca_error_names[] = {
 \*----------------------------------------------------------------------------*/
 
 static ncVolume *find_volume(ncInstance * pInstance, const char *sVolumeId);
+static instance_index *instance_index_get(bunchOfInstances * pHead);
+static int instance_index_insert(instance_index * pIndex, bunchOfInstances * pNode);
+static bunchOfInstances *instance_index_find(instance_index * pIndex, const char *sInstanceId);
+static void instance_index_delete(instance_index * pIndex, bunchOfInstances * pNode);
+static void instance_index_free(instance_index ** ppIndex);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -476,7 +500,7 @@ ncInstance *allocate_instance(const char *sUUID, const char *sInstanceId, const
     ncInstance *pInstance = NULL;
 
     /* zeroed out for cleaner-looking checkpoints and strings that are empty unless set */
-    if ((pInstance = EUCA_ZALLOC(1, sizeof(ncInstance))) == NULL)
+    if ((pInstance = EUCA_SLAB_ZALLOC(&instance_slab)) == NULL)
         return (NULL);
 
     if (sUserData)
@@ -549,8 +573,8 @@ ncInstance *clone_instance(const ncInstance * old_instance)
 {
     ncInstance *new_instance;
 
-    // zeroed out for cleaner-looking checkpoints and strings that are empty unless set
-    if ((new_instance = EUCA_ZALLOC(1, sizeof(ncInstance))) == NULL)
+    // every byte is copied over, so there is no need to zero it first
+    if ((new_instance = EUCA_SLAB_ALLOC(&instance_slab)) == NULL)
         return (NULL);
 
     //! @TODO do not just copy everything
@@ -575,7 +599,7 @@ ncInstance *clone_instance(const ncInstance * old_instance)
 void free_instance(ncInstance ** ppInstance)
 {
     if (ppInstance != NULL) {
-        EUCA_FREE((*ppInstance));
+        EUCA_SLAB_FREE(&instance_slab, (*ppInstance));
     }
 }
 
@@ -599,13 +623,19 @@ void free_instance(ncInstance ** ppInstance)
 int add_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 {
     bunchOfInstances *pNew = NULL;
-    bunchOfInstances *pLast = NULL;
-    bunchOfInstances *pNext = NULL;
+    instance_index *pIndex = NULL;
 
     // Make sure our paramters are valid
     if ((ppHead == NULL) || (pInstance == NULL))
         return (EUCA_INVALID_ERROR);
 
+    // Make sure we're not trying to add a duplicate
+    if (*ppHead != NULL) {
+        if ((pIndex = instance_index_get(*ppHead)) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        if (instance_index_find(pIndex, pInstance->instanceId) != NULL)
+            return (EUCA_DUPLICATE_ERROR);
+    }
     // Try to allocate memory for our instance list node
     if ((pNew = EUCA_ZALLOC(1, sizeof(bunchOfInstances))) == NULL)
         return (EUCA_MEMORY_ERROR);
@@ -616,25 +646,22 @@ int add_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 
     // Are we the first item in this list?
     if (*ppHead == NULL) {
+        if ((pIndex = instance_index_get(pNew)) == NULL) {
+            EUCA_FREE(pNew);
+            return (EUCA_MEMORY_ERROR);
+        }
         *ppHead = pNew;
         (*ppHead)->count = 1;
+        (*ppHead)->last = pNew;
     } else {
-        pNext = *ppHead;
-
-        //
-        // Process the list to make sure we're not trying to add a duplicate
-        //
-        do {
-            pLast = pNext;
-            if (!strcmp(pLast->instance->instanceId, pInstance->instanceId)) {
-                EUCA_FREE(pNew);
-                return (EUCA_DUPLICATE_ERROR);
-            }
-            pNext = pLast->next;
-        } while (pLast->next);
-
+        if (instance_index_insert(pIndex, pNew) != EUCA_OK) {
+            EUCA_FREE(pNew);
+            return (EUCA_MEMORY_ERROR);
+        }
         // We're at the end so add it there.
-        pLast->next = pNew;
+        pNew->prev = (*ppHead)->last;
+        (*ppHead)->last->next = pNew;
+        (*ppHead)->last = pNew;
         (*ppHead)->count++;
     }
 
@@ -660,32 +687,46 @@ int add_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 //!
 int remove_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 {
-    u32 count = 0;
     bunchOfInstances *pHead = NULL;
-    bunchOfInstances *pPrevious = NULL;
+    bunchOfInstances *pNode = NULL;
+    instance_index *pIndex = NULL;
 
     // Make sure our parameters are valid
-    if (ppHead && pInstance) {
-        for (pHead = *ppHead; pHead; pPrevious = pHead, pHead = pHead->next) {
-            count = (*ppHead)->count;
-
-            if (!strcmp(pHead->instance->instanceId, pInstance->instanceId)) {
-                if (pPrevious) {
-                    pPrevious->next = pHead->next;
-                } else {
-                    *ppHead = pHead->next;
-                }
-
-                if (*ppHead) {
-                    (*ppHead)->count = count - 1;
-                }
-                EUCA_FREE(pHead);
-                return (EUCA_OK);
-            }
-        }
+    if (!ppHead || !pInstance)
+        return (EUCA_INVALID_ERROR);
+
+    if ((pHead = *ppHead) == NULL)
         return (EUCA_NOT_FOUND_ERROR);
+
+    if ((pIndex = instance_index_get(pHead)) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    if ((pNode = instance_index_find(pIndex, pInstance->instanceId)) == NULL)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    instance_index_delete(pIndex, pNode);
+    if (pNode->next)
+        pNode->next->prev = pNode->prev;
+    if (pNode->prev)
+        pNode->prev->next = pNode->next;
+
+    if (pNode == pHead) {
+        // the list information moves on to the new head, if there is one
+        if ((*ppHead = pNode->next) != NULL) {
+            (*ppHead)->count = pHead->count - 1;
+            (*ppHead)->last = pHead->last;
+            (*ppHead)->index = pHead->index;
+        } else {
+            instance_index_free(&(pHead->index));
+        }
+    } else {
+        if (pHead->last == pNode)
+            pHead->last = pNode->prev;
+        pHead->count--;
     }
-    return (EUCA_INVALID_ERROR);
+
+    EUCA_FREE(pNode);
+    return (EUCA_OK);
 }
 
 //!
@@ -700,15 +741,18 @@ int remove_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 //!
 //! @pre Both \p ppHead and \p pFunction fields must not be NULL
 //!
-//! @post The function \p pFunction is applied to each member of the instance list.
+//! @post The function \p pFunction is applied to each member of the instance list, in the
+//!       order they were added in. The function may remove the instance it is given.
 //!
 int for_each_instance(bunchOfInstances ** ppHead, void (*pFunction) (bunchOfInstances **, ncInstance *, void *), void *pParam)
 {
     bunchOfInstances *pHead = NULL;
+    bunchOfInstances *pNext = NULL;
 
     // Make sure our parameters aren't NULL
     if (ppHead && pFunction) {
-        for (pHead = *ppHead; pHead; pHead = pHead->next) {
+        for (pHead = *ppHead; pHead; pHead = pNext) {
+            pNext = pHead->next;
             pFunction(ppHead, pHead->instance, pParam);
         }
 
@@ -730,12 +774,19 @@ int for_each_instance(bunchOfInstances ** ppHead, void (*pFunction) (bunchOfInst
 ncInstance *find_instance(bunchOfInstances ** ppHead, const char *sInstanceId)
 {
     bunchOfInstances *pHead = NULL;
+    bunchOfInstances *pNode = NULL;
+    instance_index *pIndex = NULL;
 
     // Make sure our parameters aren't NULL
-    if (ppHead && sInstanceId) {
-        for (pHead = *ppHead; pHead; pHead = pHead->next) {
-            if (!strcmp(pHead->instance->instanceId, sInstanceId)) {
-                return (pHead->instance);
+    if (ppHead && sInstanceId && ((pHead = *ppHead) != NULL)) {
+        if ((pIndex = instance_index_get(pHead)) != NULL) {
+            if ((pNode = instance_index_find(pIndex, sInstanceId)) != NULL)
+                return (pNode->instance);
+        } else {
+            // without memory for the index, do it the slow way
+            for (pNode = pHead; pNode; pNode = pNode->next) {
+                if (!strcmp(pNode->instance->instanceId, sInstanceId))
+                    return (pNode->instance);
             }
         }
     }
@@ -785,6 +836,145 @@ int total_instances(bunchOfInstances ** ppHead)
     return (0);
 }
 
+//!
+//! Returns the index of an instance list, building it from the list if the list has none yet
+//!
+//! @param[in] pHead a pointer to the head of the list
+//!
+//! @return a pointer to the index or NULL if we fail to allocate memory
+//!
+static instance_index *instance_index_get(bunchOfInstances * pHead)
+{
+    bunchOfInstances *pNode = NULL;
+    instance_index *pIndex = NULL;
+
+    if (pHead->index)
+        return (pHead->index);
+
+    if ((pIndex = EUCA_ZALLOC(1, sizeof(instance_index))) == NULL)
+        return (NULL);
+
+    pIndex->size = INSTANCE_INDEX_MIN_SLOTS;
+    if ((pIndex->slots = EUCA_ZALLOC(pIndex->size, sizeof(instance_index_slot))) == NULL) {
+        EUCA_FREE(pIndex);
+        return (NULL);
+    }
+
+    for (pNode = pHead; pNode; pNode = pNode->next) {
+        if (instance_index_insert(pIndex, pNode) != EUCA_OK) {
+            instance_index_free(&pIndex);
+            return (NULL);
+        }
+        pHead->last = pNode;
+    }
+
+    pHead->index = pIndex;
+    return (pIndex);
+}
+
+//!
+//! Adds a list node to the index of its list, growing the index past half full
+//!
+//! @param[in] pIndex a pointer to the index
+//! @param[in] pNode a pointer to the node to add
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR if we fail to grow the index
+//!
+static int instance_index_insert(instance_index * pIndex, bunchOfInstances * pNode)
+{
+    u32 i = 0;
+    u32 size = 0;
+    u64 hash = 0;
+    instance_index_slot *pSlots = NULL;
+    instance_index_slot *pOld = NULL;
+
+    if (((pIndex->count + 1) * 2) > pIndex->size) {
+        size = pIndex->size * 2;
+        if ((pSlots = EUCA_ZALLOC(size, sizeof(instance_index_slot))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+
+        for (pOld = pIndex->slots; pOld < (pIndex->slots + pIndex->size); pOld++) {
+            if (pOld->node) {
+                for (i = (pOld->hash & (size - 1)); pSlots[i].node; i = ((i + 1) & (size - 1))) ;
+                pSlots[i] = *pOld;
+            }
+        }
+
+        EUCA_FREE(pIndex->slots);
+        pIndex->slots = pSlots;
+        pIndex->size = size;
+    }
+
+    hash = euca_hash64_str(pNode->instance->instanceId);
+    for (i = (hash & (pIndex->size - 1)); pIndex->slots[i].node; i = ((i + 1) & (pIndex->size - 1))) ;
+    pIndex->slots[i].hash = hash;
+    pIndex->slots[i].node = pNode;
+    pIndex->count++;
+    return (EUCA_OK);
+}
+
+//!
+//! Looks up the list node of an instance in the index of its list
+//!
+//! @param[in] pIndex a pointer to the index
+//! @param[in] sInstanceId the instance identifier string (i-XXXXXXXX)
+//!
+//! @return a pointer to the node of the instance or NULL if it is not in the list
+//!
+static bunchOfInstances *instance_index_find(instance_index * pIndex, const char *sInstanceId)
+{
+    u32 i = 0;
+    u64 hash = euca_hash64_str(sInstanceId);
+
+    for (i = (hash & (pIndex->size - 1)); pIndex->slots[i].node; i = ((i + 1) & (pIndex->size - 1))) {
+        if ((pIndex->slots[i].hash == hash) && !strcmp(pIndex->slots[i].node->instance->instanceId, sInstanceId))
+            return (pIndex->slots[i].node);
+    }
+    return (NULL);
+}
+
+//!
+//! Removes a list node from the index of its list. The nodes after it in its probe
+//! sequence are shifted back over the freed slot, so lookups never need tombstones.
+//!
+//! @param[in] pIndex a pointer to the index
+//! @param[in] pNode a pointer to the node to remove, which must be in the index
+//!
+static void instance_index_delete(instance_index * pIndex, bunchOfInstances * pNode)
+{
+    u32 i = 0;
+    u32 j = 0;
+    u32 home = 0;
+    u32 mask = (pIndex->size - 1);
+
+    for (i = (euca_hash64_str(pNode->instance->instanceId) & mask); pIndex->slots[i].node != pNode; i = ((i + 1) & mask)) ;
+
+    pIndex->slots[i].node = NULL;
+    pIndex->count--;
+    for (j = ((i + 1) & mask); pIndex->slots[j].node; j = ((j + 1) & mask)) {
+        // an entry stays unless the freed slot lies between its home slot and where it is
+        home = (pIndex->slots[j].hash & mask);
+        if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j)))
+            continue;
+        pIndex->slots[i] = pIndex->slots[j];
+        pIndex->slots[j].node = NULL;
+        i = j;
+    }
+}
+
+//!
+//! Frees the index of an instance list
+//!
+//! @param[in,out] ppIndex a pointer to the index pointer, set to NULL
+//!
+static void instance_index_free(instance_index ** ppIndex)
+{
+    if (ppIndex && *ppIndex) {
+        EUCA_FREE((*ppIndex)->slots);
+        EUCA_FREE(*ppIndex);
+    }
+}
+
 //!
 //! Allocate and initialize a resource structure with given information. Resource is
 //! used to return information about resources
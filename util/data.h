@@ -82,6 +82,7 @@
 #include <pthread.h>
 #include "eucalyptus.h"
 #include "misc.h"                      // boolean
+#include "euca_alloc.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -127,6 +128,8 @@
 #define GUEST_STATE_POWERED_OFF "poweredOff"    //!< The instance is not found on hypervisor
 //!@}
 
+#define INSTANCE_SLAB_MAX_FREE                      8   //!< Most freed instance structures kept for reuse
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -295,6 +298,7 @@ typedef struct virtualBootRecord_t {
     char preparedResourceLocation[VERY_BIG_CHAR_BUFFER_SIZE];   //!< e.g., URL + resourceLocation for Walrus downloads, sc url for ebs volumes prior to SC call, then connection string for ebs volumes returned from SC
     //! @}
     char guestDeviceSerialId[128];     //!< Serial ID to assign to the device
+    char backingFormat[16];            //!< format of the backing file, if it is not raw (e.g., qcow2 for an image booted lazily)
 } virtualBootRecord;
 
 //! Structure defining a virtual machine
@@ -448,6 +452,27 @@ typedef struct ncInstance_t {
     boolean bail_flag;                 //!< instance termination was requested
     //! @}
     char rootDirective[SMALL_CHAR_BUFFER_SIZE]; //!< root directive provided by user in the instance manifest
+
+    //! @{
+    //! @name fields added for migration progress, updated on the source while migrating
+    int migrationProgress;             //!< percent of the memory of the instance transferred so far
+    long long migrationRemainingBytes; //!< bytes left to transfer, as of the last progress check
+    long long migrationDirtyRate;      //!< bytes per second the guest dirties, as of the last progress check
+    boolean migrationPostCopy;         //!< TRUE once the migration has switched to post-copy
+    //! @}
+
+    //! @{
+    //! @name fields added for NUMA placement
+    boolean numaPinned;                //!< TRUE if the instance is pinned to a NUMA node of the host
+    int numaNode;                      //!< NUMA node of the host the instance is pinned to, if numaPinned
+    char numaCpus[CHAR_BUFFER_SIZE];   //!< CPUs of that node, as a libvirt cpuset, if numaPinned
+    int hugePagesKB;                   //!< size of the host huge pages backing the memory of the instance, or 0 for none
+    //! @}
+
+    //! @{
+    //! @name field added for incremental DescribeInstances
+    long long generation;              //!< NC instance generation at which this instance last changed (set in global_instances_copy only)
+    //! @}
 } ncInstance;
 
 //! Structure defining NC resource information
@@ -465,12 +490,16 @@ typedef struct ncResource_t {
     char hypervisor[CHAR_BUFFER_SIZE];  //!< Node hypervisor                   
 } ncResource;
 
-//! Instance list node structure
-//! @todo make this into something smarter than a linked list
+//! Instance list node structure. The list keeps the order instances were added in and
+//! its first node carries an index of the nodes by instance identifier, so lookups,
+//! additions and removals do not walk the list.
 typedef struct bunchOfInstances_t {
     ncInstance *instance;              //!< Pointer to this node's assigned instance
     int count;                         //!< Number of instances in the list. Only valid on first node.
     struct bunchOfInstances_t *next;   //!< Pointer to our next node.
+    struct bunchOfInstances_t *prev;   //!< Pointer to our previous node, NULL on the first node.
+    struct bunchOfInstances_t *last;   //!< Pointer to the last node. Only valid on first node.
+    struct instance_index_t *index;    //!< Nodes by instance identifier. Only valid on first node.
 } bunchOfInstances;
 
 /*----------------------------------------------------------------------------*\
@@ -479,6 +508,9 @@ typedef struct bunchOfInstances_t {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Slab of the instance structures of allocate_instance() and clone_instance()
+extern euca_slab instance_slab;
+
 //! List of string to convert the hypervisor capability types enumeration
 extern const char *hypervisorCapabilityTypeNames[];
 
@@ -0,0 +1,382 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/euca_alloc.c
+//! Allocation tracking and slabs of hot fixed-size structures, see euca_alloc.h
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "eucalyptus.h"
+#include "euca_alloc.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static euca_alloc_site *alloc_sites = NULL; //!< call sites that allocated, newest first
+static euca_slab *slabs = NULL;        //!< slabs that were used, newest first
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void register_site(euca_alloc_site * site);
+static void register_slab(euca_slab * slab);
+static int compare_site_bytes(const void *a, const void *b);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Allocates memory on behalf of a call site of EUCA_ALLOC() or EUCA_ZALLOC(), counting it
+//!
+//! @param[in] site the call site
+//! @param[in] nmemb number of members
+//! @param[in] size size of each member
+//! @param[in] zero set to non-zero for zeroed memory
+//!
+//! @return the memory or NULL if out of memory
+//!
+void *euca_alloc_at(euca_alloc_site * site, size_t nmemb, size_t size, int zero)
+{
+    if (!site->registered)
+        register_site(site);
+    __sync_fetch_and_add(&(site->calls), 1);
+    __sync_fetch_and_add(&(site->bytes), (long long)(nmemb * size));
+    return (zero ? calloc(nmemb, size) : malloc(nmemb * size));
+}
+
+//!
+//! Reallocates memory on behalf of a call site of EUCA_REALLOC(), counting the new size
+//!
+//! @param[in] site the call site
+//! @param[in] ptr the memory to resize, may be NULL
+//! @param[in] nmemb number of members
+//! @param[in] size size of each member
+//!
+//! @return the memory or NULL if out of memory, in which case ptr is left as it was
+//!
+void *euca_realloc_at(euca_alloc_site * site, void *ptr, size_t nmemb, size_t size)
+{
+    if (!site->registered)
+        register_site(site);
+    __sync_fetch_and_add(&(site->calls), 1);
+    __sync_fetch_and_add(&(site->bytes), (long long)(nmemb * size));
+    return (realloc(ptr, (nmemb * size)));
+}
+
+//!
+//! Hands out an object of a slab, reusing a freed one if the slab has any
+//!
+//! @param[in] slab
+//! @param[in] zero set to non-zero to zero the object
+//!
+//! @return the object, to be given back with EUCA_SLAB_FREE(), or NULL if out of memory
+//!
+void *euca_slab_alloc(euca_slab * slab, int zero)
+{
+    void *ptr = NULL;
+
+    if (!slab->registered)
+        register_slab(slab);
+
+    pthread_mutex_lock(&(slab->mutex));
+    if ((ptr = slab->free_list) != NULL) {
+        slab->free_list = *((void **)ptr);
+        slab->free_count--;
+        slab->reuses++;
+    }
+    slab->allocs++;
+    pthread_mutex_unlock(&(slab->mutex));
+
+    if (ptr == NULL)
+        return (zero ? calloc(1, slab->size) : malloc(slab->size));
+    if (zero)
+        memset(ptr, 0, slab->size);
+    return (ptr);
+}
+
+//!
+//! Gives an object back to its slab, which keeps it for reuse unless it has max_free already
+//!
+//! @param[in] slab
+//! @param[in] ptr the object, from EUCA_SLAB_ALLOC() or a heap block of the size of the
+//!            objects of the slab, may be NULL
+//!
+void euca_slab_free(euca_slab * slab, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    if (!slab->registered)
+        register_slab(slab);
+
+    pthread_mutex_lock(&(slab->mutex));
+    slab->frees++;
+    if (slab->free_count < slab->max_free) {
+        *((void **)ptr) = slab->free_list;
+        slab->free_list = ptr;
+        slab->free_count++;
+        ptr = NULL;
+    }
+    pthread_mutex_unlock(&(slab->mutex));
+
+    free(ptr);
+}
+
+//!
+//! Gets the statistics of the call sites that allocated the most bytes
+//!
+//! @param[out] ppStats set to an array of statistics, largest first, that the caller frees
+//! @param[out] pLen set to the number of entries in the array
+//! @param[in]  max the most call sites to return
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR or EUCA_MEMORY_ERROR on failure
+//!
+int euca_alloc_stats_get(euca_alloc_site_stats ** ppStats, int *pLen, int max)
+{
+    int len = 0;
+    int size = 0;
+    euca_alloc_site *site = NULL;
+    euca_alloc_site_stats *pStats = NULL;
+
+    if ((ppStats == NULL) || (pLen == NULL) || (max < 0))
+        return (EUCA_INVALID_ERROR);
+
+    *ppStats = NULL;
+    *pLen = 0;
+    for (site = __sync_fetch_and_add(&alloc_sites, 0); site != NULL; site = site->next)
+        size++;
+    if (size == 0)
+        return (EUCA_OK);
+
+    // sites registered while we copy are not on the part of the list we walk
+    if ((pStats = calloc(size, sizeof(euca_alloc_site_stats))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    for (site = __sync_fetch_and_add(&alloc_sites, 0); (site != NULL) && (len < size); site = site->next, len++) {
+        snprintf(pStats[len].site, sizeof(pStats[len].site), "%s:%d", site->file, site->line);
+        pStats[len].kind = site->kind;
+        pStats[len].calls = __sync_fetch_and_add(&(site->calls), 0);
+        pStats[len].bytes = __sync_fetch_and_add(&(site->bytes), 0);
+    }
+
+    qsort(pStats, len, sizeof(euca_alloc_site_stats), compare_site_bytes);
+    *ppStats = pStats;
+    *pLen = ((len < max) ? len : max);
+    return (EUCA_OK);
+}
+
+//!
+//! Gets the statistics of the slabs
+//!
+//! @param[out] ppStats set to an array of statistics that the caller frees
+//! @param[out] pLen set to the number of entries in the array
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR or EUCA_MEMORY_ERROR on failure
+//!
+int euca_slab_stats_get(euca_slab_stats ** ppStats, int *pLen)
+{
+    int len = 0;
+    int size = 0;
+    euca_slab *slab = NULL;
+    euca_slab_stats *pStats = NULL;
+
+    if ((ppStats == NULL) || (pLen == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    *ppStats = NULL;
+    *pLen = 0;
+    for (slab = __sync_fetch_and_add(&slabs, 0); slab != NULL; slab = slab->next)
+        size++;
+    if (size == 0)
+        return (EUCA_OK);
+
+    if ((pStats = calloc(size, sizeof(euca_slab_stats))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    for (slab = __sync_fetch_and_add(&slabs, 0); (slab != NULL) && (len < size); slab = slab->next, len++) {
+        snprintf(pStats[len].name, sizeof(pStats[len].name), "%s", slab->name);
+        pStats[len].size = slab->size;
+        pthread_mutex_lock(&(slab->mutex));
+        pStats[len].allocs = slab->allocs;
+        pStats[len].reuses = slab->reuses;
+        pStats[len].frees = slab->frees;
+        pStats[len].free_count = slab->free_count;
+        pthread_mutex_unlock(&(slab->mutex));
+    }
+
+    *ppStats = pStats;
+    *pLen = len;
+    return (EUCA_OK);
+}
+
+//!
+//! Adds a call site to the list of sites, once
+//!
+//! @param[in] site
+//!
+static void register_site(euca_alloc_site * site)
+{
+    if (!__sync_bool_compare_and_swap(&(site->registered), 0, 1))
+        return;
+
+    do {
+        site->next = alloc_sites;
+    } while (!__sync_bool_compare_and_swap(&alloc_sites, site->next, site));
+}
+
+//!
+//! Adds a slab to the list of slabs, once
+//!
+//! @param[in] slab
+//!
+static void register_slab(euca_slab * slab)
+{
+    if (!__sync_bool_compare_and_swap(&(slab->registered), 0, 1))
+        return;
+
+    do {
+        slab->next = slabs;
+    } while (!__sync_bool_compare_and_swap(&slabs, slab->next, slab));
+}
+
+//!
+//! Orders call sites by bytes allocated, largest first, for qsort()
+//!
+//! @param[in] a pointer to an euca_alloc_site_stats
+//! @param[in] b pointer to an euca_alloc_site_stats
+//!
+//! @return -1, 0 or 1 as a allocated more, as many or fewer bytes than b
+//!
+static int compare_site_bytes(const void *a, const void *b)
+{
+    const euca_alloc_site_stats *sa = a;
+    const euca_alloc_site_stats *sb = b;
+
+    if (sa->bytes == sb->bytes)
+        return (0);
+    return ((sa->bytes > sb->bytes) ? -1 : 1);
+}
@@ -0,0 +1,241 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_EUCA_ALLOC_H_
+#define _INCLUDE_EUCA_ALLOC_H_
+
+//!
+//! @file util/euca_alloc.h
+//! Optional allocation tracking behind EUCA_ALLOC(), EUCA_ZALLOC() and EUCA_REALLOC(), and
+//! slabs that keep freed objects of a hot fixed-size structure for reuse.
+//!
+//! Both are built in with EUCA_ALLOC_TRACKING defined (configure --enable-alloc-tracking).
+//! Each call site of the allocation macros then counts its calls and bytes in a static
+//! euca_alloc_site of its own, and EUCA_SLAB_ALLOC() and EUCA_SLAB_FREE() go through the slab.
+//! Without it, the macros are plain malloc(), calloc(), realloc() and free().
+//!
+//! Objects of a slab are plain heap blocks of the size of the structure, so one released with
+//! EUCA_FREE() or allocated with EUCA_ZALLOC() instead of through the slab is still correct,
+//! just not reused.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A call site of the allocation macros, which registers itself on its first call
+typedef struct euca_alloc_site_t {
+    const char *file;                  //!< source file of the call site
+    int line;                          //!< line of the call site
+    const char *kind;                  //!< "alloc", "zalloc" or "realloc"
+    long long calls;                   //!< allocations made from the site
+    long long bytes;                   //!< bytes requested from the site
+    int registered;                    //!< set once the site is in the list of sites
+    struct euca_alloc_site_t *next;    //!< the site registered before this one
+} euca_alloc_site;
+
+//! A slab of objects of one fixed-size structure, which keeps up to max_free freed objects
+typedef struct euca_slab_t {
+    const char *name;                  //!< name of the structure, for the statistics
+    size_t size;                       //!< size of the objects
+    int max_free;                      //!< most freed objects kept for reuse
+    pthread_mutex_t mutex;             //!< guards free_list and free_count
+    void *free_list;                   //!< freed objects, each starting with a pointer to the next
+    int free_count;                    //!< number of objects in free_list
+    long long allocs;                  //!< objects handed out
+    long long reuses;                  //!< objects handed out from free_list
+    long long frees;                   //!< objects given back
+    int registered;                    //!< set once the slab is in the list of slabs
+    struct euca_slab_t *next;          //!< the slab registered before this one
+} euca_slab;
+
+//! Statistics of one call site, as returned by euca_alloc_stats_get()
+typedef struct euca_alloc_site_stats_t {
+    char site[128];                    //!< file:line of the call site
+    const char *kind;                  //!< "alloc", "zalloc" or "realloc"
+    long long calls;
+    long long bytes;
+} euca_alloc_site_stats;
+
+//! Statistics of one slab, as returned by euca_slab_stats_get()
+typedef struct euca_slab_stats_t {
+    char name[64];
+    size_t size;
+    long long allocs;
+    long long reuses;
+    long long frees;
+    int free_count;                    //!< objects kept for reuse right now
+} euca_slab_stats;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+void *euca_alloc_at(euca_alloc_site * site, size_t nmemb, size_t size, int zero);
+void *euca_realloc_at(euca_alloc_site * site, void *ptr, size_t nmemb, size_t size);
+void *euca_slab_alloc(euca_slab * slab, int zero);
+void euca_slab_free(euca_slab * slab, void *ptr);
+int euca_alloc_stats_get(euca_alloc_site_stats ** ppStats, int *pLen, int max);
+int euca_slab_stats_get(euca_slab_stats ** ppStats, int *pLen);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Static initializer of a call site
+#define EUCA_ALLOC_SITE_INITIALIZER(_kind)       { __FILE__, __LINE__, (_kind), 0, 0, 0, NULL }
+
+//! Static initializer of a slab of structures of type _type keeping up to _max_free of them
+#define EUCA_SLAB_INITIALIZER(_name, _type, _max_free) \
+    { (_name), sizeof(_type), (_max_free), PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, 0, NULL }
+
+#ifdef EUCA_ALLOC_TRACKING
+//! Allocation counted against the call site
+#define EUCA_TRACKED_ALLOC(_nmemb, _size) \
+    ({ static euca_alloc_site _euca_site = EUCA_ALLOC_SITE_INITIALIZER("alloc"); euca_alloc_at(&_euca_site, (_nmemb), (_size), 0); })
+
+//! Zeroed allocation counted against the call site
+#define EUCA_TRACKED_ZALLOC(_nmemb, _size) \
+    ({ static euca_alloc_site _euca_site = EUCA_ALLOC_SITE_INITIALIZER("zalloc"); euca_alloc_at(&_euca_site, (_nmemb), (_size), 1); })
+
+//! Reallocation counted against the call site
+#define EUCA_TRACKED_REALLOC(_ptr, _nmemb, _size) \
+    ({ static euca_alloc_site _euca_site = EUCA_ALLOC_SITE_INITIALIZER("realloc"); euca_realloc_at(&_euca_site, (_ptr), (_nmemb), (_size)); })
+
+//! Object of a slab, not zeroed
+#define EUCA_SLAB_ALLOC(_slab)                   euca_slab_alloc((_slab), 0)
+
+//! Zeroed object of a slab
+#define EUCA_SLAB_ZALLOC(_slab)                  euca_slab_alloc((_slab), 1)
+
+//! Gives an object back to its slab and sets the pointer to NULL
+#define EUCA_SLAB_FREE(_slab, _x)   \
+{                                   \
+    euca_slab_free((_slab), (_x));  \
+    (_x) = NULL;                    \
+}
+#else /* ! EUCA_ALLOC_TRACKING */
+#define EUCA_SLAB_ALLOC(_slab)                   malloc((_slab)->size)
+#define EUCA_SLAB_ZALLOC(_slab)                  calloc(1, (_slab)->size)
+#define EUCA_SLAB_FREE(_slab, _x)   \
+{                                   \
+    free((_x));                     \
+    (_x) = NULL;                    \
+}
+#endif /* ! EUCA_ALLOC_TRACKING */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_EUCA_ALLOC_H_ */
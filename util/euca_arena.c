@@ -0,0 +1,419 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/euca_arena.c
+//! Bump allocator for short-lived objects, see euca_arena.h
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "eucalyptus.h"
+#include "log.h"
+#include "euca_arena.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define ALIGN_UP(_n)                             (((_n) + (EUCA_ARENA_ALIGN - 1)) & ~((size_t) (EUCA_ARENA_ALIGN - 1)))
+#define CHUNK_HEADER_SIZE                        ALIGN_UP(sizeof(euca_arena_chunk))
+#define CHUNK_DATA(_chunk)                       (((char *) (_chunk)) + CHUNK_HEADER_SIZE)
+#define BLOCK_HEADER_SIZE                        EUCA_ARENA_ALIGN   //!< each block starts with its size, for euca_arena_realloc()
+#define BLOCK_SIZE(_ptr)                         (*((size_t *) (((char *) (_ptr)) - BLOCK_HEADER_SIZE)))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static euca_arena_chunk *add_chunk(euca_arena * arena, size_t size, boolean current);
+
+#ifdef _UNIT_TEST
+int main(int argc, char **argv);
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Creates an empty arena
+//!
+//! @param[in] chunk_size size of the chunks taken from malloc(), or 0 for EUCA_ARENA_CHUNK_SIZE
+//!
+//! @return the arena, to be released with euca_arena_destroy(), or NULL if out of memory
+//!
+euca_arena *euca_arena_create(size_t chunk_size)
+{
+    euca_arena *arena = NULL;
+
+    if ((arena = EUCA_ZALLOC(1, sizeof(euca_arena))) == NULL)
+        return (NULL);
+    arena->chunk_size = ((chunk_size > 0) ? ALIGN_UP(chunk_size) : EUCA_ARENA_CHUNK_SIZE);
+    return (arena);
+}
+
+//!
+//! Releases an arena and everything allocated from it
+//!
+//! @param[in] arena may be NULL
+//!
+void euca_arena_destroy(euca_arena * arena)
+{
+    euca_arena_chunk *chunk = NULL;
+
+    if (arena == NULL)
+        return;
+
+    while ((chunk = arena->chunks) != NULL) {
+        arena->chunks = chunk->next;
+        EUCA_FREE(chunk);
+    }
+    EUCA_FREE(arena);
+}
+
+//!
+//! Releases everything allocated from an arena, keeping one chunk for the next allocations
+//!
+//! @param[in] arena may be NULL
+//!
+void euca_arena_reset(euca_arena * arena)
+{
+    euca_arena_chunk *chunk = NULL;
+    euca_arena_chunk *kept = NULL;
+
+    if (arena == NULL)
+        return;
+
+    while ((chunk = arena->chunks) != NULL) {
+        arena->chunks = chunk->next;
+        if ((kept == NULL) && (chunk->size == arena->chunk_size)) {
+            kept = chunk;
+        } else {
+            arena->bytes -= (CHUNK_HEADER_SIZE + chunk->size);
+            EUCA_FREE(chunk);
+        }
+    }
+
+    if (kept != NULL) {
+        kept->next = NULL;
+        kept->used = 0;
+        arena->chunks = kept;
+    }
+    arena->allocs = 0;
+}
+
+//!
+//! Allocates memory from an arena. The memory is not zeroed and is released along with the arena.
+//!
+//! @param[in] arena
+//! @param[in] size
+//!
+//! @return the memory, aligned on EUCA_ARENA_ALIGN, or NULL if out of memory
+//!
+void *euca_arena_alloc(euca_arena * arena, size_t size)
+{
+    char *block = NULL;
+    size_t need = BLOCK_HEADER_SIZE + ALIGN_UP((size > 0) ? size : 1);
+    euca_arena_chunk *chunk = NULL;
+
+    if (arena == NULL)
+        return (NULL);
+
+    if (((chunk = arena->chunks) == NULL) || ((chunk->size - chunk->used) < need)) {
+        // large blocks get a chunk of their own, so the chunk being filled is not wasted
+        if ((chunk = add_chunk(arena, ((need > (arena->chunk_size / 4)) ? need : arena->chunk_size), (need <= (arena->chunk_size / 4)))) == NULL)
+            return (NULL);
+    }
+
+    block = CHUNK_DATA(chunk) + chunk->used;
+    chunk->used += need;
+    *((size_t *) block) = size;
+    arena->allocs++;
+    return (block + BLOCK_HEADER_SIZE);
+}
+
+//!
+//! Resizes memory allocated from an arena, in place if it is the last block of the chunk being filled
+//!
+//! @param[in] arena
+//! @param[in] ptr the memory, or NULL to allocate
+//! @param[in] size the new size
+//!
+//! @return the memory, or NULL if out of memory, in which case ptr is left as is
+//!
+void *euca_arena_realloc(euca_arena * arena, void *ptr, size_t size)
+{
+    size_t old = 0;
+    char *end = NULL;
+    void *moved = NULL;
+    euca_arena_chunk *chunk = NULL;
+
+    if (ptr == NULL)
+        return (euca_arena_alloc(arena, size));
+
+    if ((old = BLOCK_SIZE(ptr)) >= size)
+        return (ptr);
+
+    if ((chunk = arena->chunks) != NULL) {
+        end = CHUNK_DATA(chunk) + chunk->used;
+        if ((((char *)ptr) + ALIGN_UP((old > 0) ? old : 1)) == end && ((chunk->size - chunk->used) >= (ALIGN_UP(size) - ALIGN_UP((old > 0) ? old : 1)))) {
+            chunk->used += (ALIGN_UP(size) - ALIGN_UP((old > 0) ? old : 1));
+            BLOCK_SIZE(ptr) = size;
+            return (ptr);
+        }
+    }
+
+    if ((moved = euca_arena_alloc(arena, size)) != NULL)
+        memcpy(moved, ptr, old);
+    return (moved);
+}
+
+//!
+//! Duplicates a string into an arena
+//!
+//! @param[in] arena
+//! @param[in] s may be NULL
+//!
+//! @return the copy, or NULL if s is NULL or out of memory
+//!
+char *euca_arena_strdup(euca_arena * arena, const char *s)
+{
+    char *copy = NULL;
+    size_t len = 0;
+
+    if (s == NULL)
+        return (NULL);
+
+    len = strlen(s) + 1;
+    if ((copy = euca_arena_alloc(arena, len)) != NULL)
+        memcpy(copy, s, len);
+    return (copy);
+}
+
+//!
+//! Tells how much memory an arena holds
+//!
+//! @param[in] arena may be NULL
+//!
+//! @return the bytes taken from malloc(), 0 for no arena
+//!
+size_t euca_arena_bytes(const euca_arena * arena)
+{
+    return ((arena != NULL) ? arena->bytes : 0);
+}
+
+//!
+//! Adds a chunk to an arena
+//!
+//! @param[in] arena
+//! @param[in] size usable bytes of the chunk
+//! @param[in] current TRUE if the chunk becomes the one being filled, FALSE to put it behind
+//!            that one, for a block that fills the chunk
+//!
+//! @return the chunk or NULL if out of memory
+//!
+static euca_arena_chunk *add_chunk(euca_arena * arena, size_t size, boolean current)
+{
+    euca_arena_chunk *chunk = NULL;
+
+    if ((chunk = EUCA_ALLOC(1, (CHUNK_HEADER_SIZE + size))) == NULL) {
+        LOGERROR("out of memory for a %lu bytes arena chunk\n", (unsigned long)size);
+        return (NULL);
+    }
+    chunk->size = size;
+    chunk->used = 0;
+    if (current || (arena->chunks == NULL)) {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    } else {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    }
+    arena->bytes += (CHUNK_HEADER_SIZE + size);
+    return (chunk);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int errors = 0;
+    char *s = NULL;
+    char *big = NULL;
+    void *blocks[1000] = { NULL };
+    size_t bytes = 0;
+    euca_arena *arena = NULL;
+
+    logfile(NULL, EUCA_LOG_DEBUG, 4);
+    if ((arena = euca_arena_create(4096)) == NULL) {
+        LOGERROR("failed to create an arena\n");
+        return (EUCA_ERROR);
+    }
+
+    for (i = 0; i < 1000; i++) {
+        if (((blocks[i] = euca_arena_alloc(arena, (i % 100))) == NULL) || (((unsigned long)blocks[i]) % EUCA_ARENA_ALIGN)) {
+            LOGERROR("bad block %d at %p\n", i, blocks[i]);
+            errors++;
+        }
+        memset(blocks[i], (i & 0xff), (i % 100));
+    }
+    for (i = 0; i < 1000; i++) {
+        if (((i % 100) > 0) && (((unsigned char *)blocks[i])[(i % 100) - 1] != (i & 0xff))) {
+            LOGERROR("block %d was overwritten\n", i);
+            errors++;
+        }
+    }
+
+    // grown in place, then moved, with the content kept
+    s = euca_arena_strdup(arena, "arena");
+    if (((s = euca_arena_realloc(arena, s, 4000)) == NULL) || strcmp(s, "arena")) {
+        LOGERROR("realloc lost the content\n");
+        errors++;
+    }
+    big = euca_arena_alloc(arena, 100000);
+    if ((big == NULL) || (arena->chunks->size < 4096) || ((s = euca_arena_realloc(arena, s, 8000)) == NULL) || strcmp(s, "arena")) {
+        LOGERROR("large block or second realloc failed\n");
+        errors++;
+    }
+
+    bytes = euca_arena_bytes(arena);
+    euca_arena_reset(arena);
+    if ((euca_arena_bytes(arena) >= bytes) || (euca_arena_bytes(arena) == 0) || (arena->allocs != 0) || (euca_arena_alloc(arena, 10) == NULL)) {
+        LOGERROR("reset kept %lu of %lu bytes\n", (unsigned long)euca_arena_bytes(arena), (unsigned long)bytes);
+        errors++;
+    }
+    euca_arena_destroy(arena);
+
+    printf("arena tests %s\n", ((errors == 0) ? "passed" : "FAILED"));
+    return ((errors == 0) ? EUCA_OK : EUCA_ERROR);
+}
+#endif /* _UNIT_TEST */
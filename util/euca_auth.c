@@ -97,8 +97,17 @@
 #include <regex.h>
 #include <arpa/inet.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EUCA_SIMD_X86
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define EUCA_SIMD_NEON
+#include <arm_neon.h>
+#endif /* __x86_64__ || __i386__ */
+
 #include "eucalyptus.h"
 #include "misc.h"
+#include "euca_string.h"
 #include "euca_auth.h"
 
 /*----------------------------------------------------------------------------*\
@@ -108,6 +117,7 @@
 \*----------------------------------------------------------------------------*/
 
 #define FILENAME                                 512    //!< Maximum filename length
+#define MAX_CRYPTO_FILES                          8     //!< Most key and certificate files kept parsed at once
 
 #ifndef IV_LENGTH
 #define IV_LENGTH                                 12
@@ -129,6 +139,14 @@
 #define MAX_DECRYPTED_STRING_LEN                8192
 #endif /* ! MAX_DECRYPTED_STRING_LEN */
 
+#define B64_PAD                                 0xFE    //!< b64_values[] of '='
+#define B64_SPACE                               0xFD    //!< b64_values[] of whitespace, which decoding skips
+#define B64_INVALID                             0xFF    //!< b64_values[] of characters outside of base64
+
+#define URL_MATCHES                                9    //!< number of groups in url_pattern, including the whole match
+#define SIGN_ARENA_SIZE                         8192    //!< stack space for canonicalizing a request to sign
+#define MAX_SIGNATURE_LEN                       1024    //!< largest RSA signature, for 8192-bit keys
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -147,6 +165,24 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A bump allocator over a caller-provided buffer, for the short-lived strings of a request to sign
+typedef struct sign_arena_t {
+    char *base;                        //!< the buffer
+    size_t size;                       //!< its size
+    size_t used;                       //!< how much of it is allocated
+} sign_arena;
+
+//! A private key or certificate file, parsed once and kept until the file changes
+typedef struct crypto_file_t {
+    char path[FILENAME];               //!< the file, or "" for a free slot
+    boolean is_cert;                   //!< TRUE for a certificate file, FALSE for a private key file
+    struct stat st;                    //!< the file when it was read
+    char *pem;                         //!< the content of the file
+    EVP_PKEY *pkey;                    //!< the private key, or the public key of the certificate
+    X509 *cert;                        //!< the certificate, or NULL for a private key file
+    char *fingerprint;                 //!< fingerprint of the certificate, computed on first use
+} crypto_file;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -174,6 +210,23 @@ static char sCloudCertFileName[FILENAME] = "";  //!< Cloud public cert file name
 
 static char hex_digits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
 
+//! The base64 alphabet
+static const char b64_chars[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//! The value of each base64 character, or B64_PAD, B64_SPACE or B64_INVALID
+static u8 b64_values[256] = { 0 };
+
+//! Guards the initialization of b64_values[] and the choice of codecs
+static pthread_once_t codecs_once = PTHREAD_ONCE_INIT;
+
+static size_t b64_encode_scalar(const u8 * in, size_t len, char *out);
+static int b64_decode_scalar(const char *in, size_t len, u8 * out, size_t * pOutLen);
+static void hex_encode_scalar(const u8 * in, size_t len, char *out);
+
+static size_t(*b64_encode_fn) (const u8 * in, size_t len, char *out) = b64_encode_scalar;  //!< the base64 encoder for this CPU
+static int (*b64_decode_fn) (const char *in, size_t len, u8 * out, size_t * pOutLen) = b64_decode_scalar;   //!< the base64 decoder for this CPU
+static void (*hex_encode_fn) (const u8 * in, size_t len, char *out) = hex_encode_scalar;   //!< the hex encoder for this CPU
+
 static regex_t *uri_regex = NULL;
 
 //! Mutex to guard initialization and compile of the uri_regex
@@ -185,6 +238,12 @@ static const char *url_pattern = "([^:?&]+://)([^:/?&]+)(:([0-9]+)?)?(/[^?&=]*)?
 //! Mutex to guard certificate and ssl init to enforce the function as a singleton.
 static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static crypto_file crypto_files[MAX_CRYPTO_FILES] = { {{0}} };   //!< The cached keys and certificates
+static u32 crypto_files_next = 0;      //!< The slot to reuse next once all of crypto_files[] is taken
+
+//! Mutex to guard crypto_files[], and the private key operations on them on OpenSSL releases without locking callbacks
+static pthread_mutex_t crypto_files_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -193,7 +252,20 @@ static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int compare_keys(const void *arg0, const void *arg1);
 static int count_query_params(const char *query_str);
+static int split_header(const char *header_str, char delimiter, size_t * pNameStart, size_t * pNameLen, size_t * pValueStart, size_t * pValueLen);
+static char *arena_alloc(sign_arena * arena, size_t size);
+static char *arena_strndup(sign_arena * arena, const char *str, size_t len);
+static char *canonicalize_request(sign_arena * arena, const char *verb, const char *url, const struct curl_slist *headers, char **pSignedHeaders);
+static boolean same_file(const struct stat *a, const struct stat *b);
+static void crypto_file_clear(crypto_file * file);
+static crypto_file *crypto_file_get(const char *path, boolean is_cert);
+static const char *crypto_file_fingerprint(crypto_file * file);
+static EVP_PKEY_CTX *crypto_file_ctx(const char *path, boolean is_cert);
+static int pkey_decrypt(EVP_PKEY_CTX * ctx, u8 * out, size_t * outlen, const u8 * in, size_t inlen);
+static RSA *get_node_key(char *fingerprint, size_t fingerprint_len);
+static int node_key_sign(int type, const u8 * digest, u32 digest_len, u8 * sig, u32 * siglen, RSA * rsa);
 static void init_url_regex(void);
+static void codecs_init(void);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -619,9 +691,8 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
     int ret = -1;
     int in_buffer_str_size = -1;
     char *dec64 = NULL;
-    int out_size = 0;
-    FILE *PKFP = NULL;
-    RSA *pr = NULL;
+    size_t out_size = 0;
+    EVP_PKEY_CTX *ctx = NULL;
 
     // Make sure we have valid parameters
     if ((in_buffer == NULL) || (pk_file == NULL) || (*pk_file == '\0') || (out_buffer == NULL)) {
@@ -638,23 +709,18 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
 
     in_buffer_str_size = (int)strlen(in_buffer);    //! the length of the string, not including the null-terminator
 
-    // Open the private key file in read mode
-    if ((PKFP = fopen(pk_file, "r")) == NULL) {
-        LOGERROR("Cannot open key file: open failed on %s\n", pk_file);
+    // Get the key, parsed the first time the file is used
+    if ((ctx = euca_get_key_ctx(pk_file)) == NULL) {
+        LOGERROR("Private key file read failed\n");
         ret = EUCA_ERROR;
         goto cleanup;
     }
-    // Get the key
-    if (PEM_read_RSAPrivateKey(PKFP, &pr, NULL, NULL) == NULL) {
-        LOGERROR("Private key file read failed\n");
-        fclose(PKFP);
-        PKFP = NULL;
+
+    if ((EVP_PKEY_decrypt_init(ctx) <= 0) || (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0)) {
+        LOGERROR("Cannot decrypt with private key file %s\n", pk_file);
         ret = EUCA_ERROR;
         goto cleanup;
     }
-    // No longer need the file handler
-    fclose(PKFP);
-    PKFP = NULL;
 
     //Base64 decode the string, null terminator deducted from buffer size
     if ((dec64 = base64_dec((unsigned char *)in_buffer, in_buffer_str_size)) == NULL) {
@@ -671,7 +737,8 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
         bzero(*out_buffer, in_buffer_str_size + 1);
     }
 
-    if ((out_size = RSA_private_decrypt(RSA_size(pr), ((unsigned char *)dec64), ((unsigned char *)*out_buffer), pr, RSA_PKCS1_PADDING)) == -1) {
+    out_size = in_buffer_str_size;
+    if (pkey_decrypt(ctx, ((u8 *) * out_buffer), &out_size, ((u8 *) dec64), EVP_PKEY_size(EVP_PKEY_CTX_get0_pkey(ctx))) != 1) {
         LOGERROR("private decrypt failed\n");
         ret = EUCA_ERROR;
         goto cleanup;
@@ -685,8 +752,8 @@ cleanup:
         EUCA_FREE(*out_buffer);
     }
 
-    if (pr != NULL) {
-        RSA_free(pr);
+    if (ctx != NULL) {
+        EVP_PKEY_CTX_free(ctx);
     }
 
     return ret;
@@ -704,17 +771,13 @@ cleanup:
 //!
 int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
 {
-    int rc = -1;
     int key_bits = -1;
     int ret = -1;
     int in_buffer_str_size = -1;
-    int encrypt_size = -1;
+    size_t encrypt_size = 0;
     char *enc64 = NULL;
-    RSA *pr = NULL;
-    BIO *cert_bio = NULL;
-    BIO *out_bio = NULL;
-    X509 *cert = NULL;
     EVP_PKEY *pubkey = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
 
     // Make sure we have valid parameters
     if ((in_buffer == NULL) || (cert_file == NULL) || (*cert_file == '\0') || (out_buffer == NULL)) {
@@ -732,57 +795,40 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
 
     in_buffer_str_size = (int)strlen(in_buffer);
 
-    // create a BIO buffer for the cert contents
-    cert_bio = BIO_new(BIO_s_file());
-    out_bio = BIO_new(BIO_s_file());
-    out_bio = BIO_new_fp(stdout, BIO_NOCLOSE);
-
-    //Read cert
-    rc = BIO_read_filename(cert_bio, cert_file);
-    if (!rc) {
-        LOGERROR("read file return error\n");
+    //Get the public key of the cert, parsed the first time the file is used
+    if ((ctx = euca_get_cert_ctx(cert_file)) == NULL) {
+        LOGERROR("Error loading cert into memory..\n");
         ret = EUCA_ERROR;
         goto cleanup;
     }
 
-    if (!(cert = PEM_read_bio_X509(cert_bio, NULL, 0, NULL))) {
-        LOGERROR("Error loading cert into memory..\n");
+    pubkey = EVP_PKEY_CTX_get0_pkey(ctx);
+    switch (EVP_PKEY_id(pubkey)) {
+    case EVP_PKEY_RSA:
+        key_bits = EVP_PKEY_bits(pubkey);
+        if (key_bits != 1024 && key_bits != 2048 && key_bits != 4096) {
+            LOGERROR("Invalid RSA key length found in %s. Requires 1024, 2048, or 4096. Found %d\n", cert_file, key_bits);
+            ret = EUCA_ERROR;
+            goto cleanup;
+        }
+        break;
+    case EVP_PKEY_DSA:
+        LOGERROR("Invalid DSA key found. Only RSA supported.\n");
         ret = EUCA_ERROR;
         goto cleanup;
-    }
-    //Get the public key and populate the RSA struct
-    if ((pubkey = X509_get_pubkey(cert)) == NULL) {
-        LOGERROR("ERROR getting pub key\n");
+    default:
+        LOGERROR("Unsupported %d bit non-RSA/DSA Key found", EVP_PKEY_bits(pubkey));
         ret = EUCA_ERROR;
         goto cleanup;
-    } else {
-        switch (pubkey->type) {
-        case EVP_PKEY_RSA:
-            key_bits = EVP_PKEY_bits(pubkey);
-            if (key_bits != 1024 && key_bits != 2048 && key_bits != 4096) {
-                LOGERROR("Invalid RSA key length found in %s. Requires 1024, 2048, or 4096. Found %d\n", cert_file, key_bits);
-                ret = EUCA_ERROR;
-                goto cleanup;
-            }
-            break;
-        case EVP_PKEY_DSA:
-            LOGERROR("Invalid DSA key found. Only RSA supported.\n");
-            ret = EUCA_ERROR;
-            goto cleanup;
-        default:
-            LOGERROR("Unsupported %d bit non-RSA/DSA Key found", EVP_PKEY_bits(pubkey));
-            ret = EUCA_ERROR;
-            goto cleanup;
-        }
     }
 
-    if ((pr = EVP_PKEY_get1_RSA(pubkey)) == NULL) {
+    if ((EVP_PKEY_encrypt_init(ctx) <= 0) || (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0)) {
         LOGERROR("Could not get public RSA key for encrypting\n");
         ret = EUCA_ERROR;
         goto cleanup;
     }
 
-    if ((encrypt_size = RSA_size(pr)) <= 0) {
+    if ((encrypt_size = EVP_PKEY_size(pubkey)) <= 0) {
         LOGERROR("Failed to read expected encryption size from RSA based on key\n");
         ret = EUCA_ERROR;
         goto cleanup;
@@ -794,8 +840,7 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
         goto cleanup;
     }
 
-    rc = RSA_public_encrypt(in_buffer_str_size, ((unsigned char *)in_buffer), ((unsigned char *)enc64), pr, RSA_PKCS1_PADDING);
-    if (rc == -1) {
+    if (EVP_PKEY_encrypt(ctx, ((u8 *) enc64), &encrypt_size, ((u8 *) in_buffer), in_buffer_str_size) != 1) {
         LOGERROR("Failed encrypt op\n");
         ret = EUCA_ERROR;
         goto cleanup;
@@ -810,22 +855,10 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
     ret = EUCA_OK;
 
 cleanup:
-    if (pr != NULL) {
-        RSA_free(pr);
-    }
-
-    if (cert_bio != NULL) {
-        BIO_free(cert_bio);
-    }
-
     EUCA_FREE(enc64);
 
-    if (cert != NULL) {
-        X509_free(cert);
-    }
-
-    if (pr != NULL) {
-        RSA_free(pr);
+    if (ctx != NULL) {
+        EVP_PKEY_CTX_free(ctx);
     }
 
     return ret;
@@ -890,11 +923,10 @@ int decrypt_string_with_node(char *in_str, char **out_buffer)
 char *euca_get_cert(u8 options)
 {
     int s = 0;
-    int fd = -1;
     int got = 0;
+    char *pem = NULL;
     char *sCert = NULL;
-    ssize_t ret = -1;
-    struct stat st = { 0 };
+    crypto_file *file = NULL;
 
     if (!initialized) {
         if (euca_init_cert() != EUCA_OK) {
@@ -902,51 +934,467 @@ char *euca_get_cert(u8 options)
         }
     }
 
-    if (stat(sCertFileName, &st) != 0) {
-        LOGERROR("cannot stat the certificate file %s\n", sCertFileName);
-    } else if ((s = st.st_size * 2) < 1) {  // *2 because we'll add characters
-        LOGERROR("certificate file %s is too small\n", sCertFileName);
-    } else if ((sCert = EUCA_ALLOC((s + 1), sizeof(char))) == NULL) {
-        LOGERROR("out of memory\n");
-    } else if ((fd = open(sCertFileName, O_RDONLY)) < 0) {
-        LOGERROR("failed to open certificate file %s\n", sCertFileName);
-        EUCA_FREE(sCert);
-        sCert = NULL;
-    } else {
-        while ((got < s) && ((ret = read(fd, sCert + got, 1)) == 1)) {
-            if (options & CONCATENATE_CERT) {   // omit all newlines
-                if (sCert[got] == '\n')
-                    continue;
-            } else {
-                if (options & INDENT_CERT) {    // indent lines 2 through N with TABs
+    pthread_mutex_lock(&crypto_files_mutex);
+    {
+        if ((file = crypto_file_get(sCertFileName, TRUE)) == NULL) {
+            LOGERROR("cannot read the certificate file %s\n", sCertFileName);
+        } else if ((s = strlen(file->pem) * 2) < 1) {  // *2 because we'll add characters
+            LOGERROR("certificate file %s is too small\n", sCertFileName);
+        } else if ((sCert = EUCA_ALLOC((s + 1), sizeof(char))) == NULL) {
+            LOGERROR("out of memory\n");
+        } else {
+            for (pem = file->pem; (got < s) && (*pem != '\0'); pem++) {
+                sCert[got] = *pem;
+                if (options & CONCATENATE_CERT) {   // omit all newlines
                     if (sCert[got] == '\n')
-                        sCert[++got] = '\t';
+                        continue;
+                } else {
+                    if (options & INDENT_CERT) {    // indent lines 2 through N with TABs
+                        if (sCert[got] == '\n')
+                            sCert[++got] = '\t';
+                    }
                 }
+                got++;
             }
-            got++;
-        }
 
-        if (ret != 0) {
-            LOGERROR("failed to read whole certificate file %s\n", sCertFileName);
-            EUCA_FREE(sCert);
-            sCert = NULL;
-        } else {
             if (options & TRIM_CERT) {
-                if ((sCert[got - 1] == '\t') || (sCert[got - 1] == '\n'))
+                if ((got > 0) && ((sCert[got - 1] == '\t') || (sCert[got - 1] == '\n')))
                     got--;
 
-                if (sCert[got - 1] == '\n')
+                if ((got > 0) && (sCert[got - 1] == '\n'))
                     got--;             // because of indenting
             }
 
             sCert[got] = '\0';
         }
-
-        close(fd);
     }
+    pthread_mutex_unlock(&crypto_files_mutex);
     return (sCert);
 }
 
+//!
+//! Encodes to base64, 3 bytes at a time
+//!
+//! @param[in]  in the data
+//! @param[in]  len its length
+//! @param[out] out room for EUCA_BASE64_ENCODED_LEN(len) characters
+//!
+//! @return the number of characters written, with padding
+//!
+static size_t b64_encode_scalar(const u8 * in, size_t len, char *out)
+{
+    u32 v = 0;
+    char *o = out;
+
+    for (; len >= 3; len -= 3, in += 3, o += 4) {
+        v = (in[0] << 16) | (in[1] << 8) | in[2];
+        o[0] = b64_chars[(v >> 18) & 0x3F];
+        o[1] = b64_chars[(v >> 12) & 0x3F];
+        o[2] = b64_chars[(v >> 6) & 0x3F];
+        o[3] = b64_chars[v & 0x3F];
+    }
+
+    if (len > 0) {
+        v = (in[0] << 16) | ((len > 1) ? (in[1] << 8) : 0);
+        o[0] = b64_chars[(v >> 18) & 0x3F];
+        o[1] = b64_chars[(v >> 12) & 0x3F];
+        o[2] = ((len > 1) ? b64_chars[(v >> 6) & 0x3F] : '=');
+        o[3] = '=';
+        o += 4;
+    }
+    return (o - out);
+}
+
+//!
+//! Decodes base64, one character at a time. Whitespace is skipped, padding is optional, and
+//! nothing but padding and whitespace may follow the first '='.
+//!
+//! @param[in]  in the base64 text
+//! @param[in]  len its length
+//! @param[out] out room for EUCA_BASE64_DECODED_MAX(len) bytes
+//! @param[out] pOutLen set to the number of bytes written
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the text is not valid base64
+//!
+static int b64_decode_scalar(const char *in, size_t len, u8 * out, size_t * pOutLen)
+{
+    u32 v = 0;
+    u8 c = 0;
+    int bits = 0;
+    boolean padded = FALSE;
+    const u8 *p = (const u8 *)in;
+    const u8 *end = p + len;
+    u8 *o = out;
+
+    for (; p < end; p++) {
+        if ((c = b64_values[*p]) < 64) {
+            if (padded)
+                return (EUCA_INVALID_ERROR);
+            v = (v << 6) | c;
+            if ((bits += 6) >= 8) {
+                bits -= 8;
+                *(o++) = (u8) (v >> bits);
+            }
+        } else if (c == B64_PAD) {
+            padded = TRUE;
+        } else if (c != B64_SPACE) {
+            return (EUCA_INVALID_ERROR);
+        }
+    }
+
+    // a lone character left over does not make a byte
+    if (bits >= 6)
+        return (EUCA_INVALID_ERROR);
+    *pOutLen = o - out;
+    return (EUCA_OK);
+}
+
+//!
+//! Writes the hex digits of bytes
+//!
+//! @param[in]  in the data
+//! @param[in]  len its length
+//! @param[out] out room for (len * 2) characters
+//!
+static void hex_encode_scalar(const u8 * in, size_t len, char *out)
+{
+    for (size_t i = 0; i < len; i++) {
+        out[i * 2] = hex_digits[(in[i] >> 4)];
+        out[i * 2 + 1] = hex_digits[(in[i] & 0x0F)];
+    }
+}
+
+#ifdef EUCA_SIMD_X86
+//!
+//! Turns 16 6-bit indices into base64 characters: a saturated subtract and a compare sort
+//! them into ranges (A-Z, a-z, 0-9, '+', '/'), then a shuffle looks up the offset of each range
+//!
+//! @param[in] indices
+//!
+//! @return the characters
+//!
+__attribute__ ((target("ssse3")))
+static inline __m128i b64_translate_ssse3(__m128i indices)
+{
+    const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return (_mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices));
+}
+
+//!
+//! Encodes 12 bytes into 16 characters per step with SSSE3, leaving the tail to the scalar code.
+//! The bytes are spread so that each 32-bit lane holds 3 of them, and multiplies shift the
+//! four 6-bit fields of each lane into bytes of their own.
+//!
+//! @param[in]  in see b64_encode_scalar()
+//! @param[in]  len see b64_encode_scalar()
+//! @param[out] out see b64_encode_scalar()
+//!
+//! @return see b64_encode_scalar()
+//!
+__attribute__ ((target("ssse3")))
+static size_t b64_encode_ssse3(const u8 * in, size_t len, char *out)
+{
+    char *o = out;
+    __m128i v = _mm_setzero_si128();
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+
+    for (; len >= 16; len -= 12, in += 12, o += 16) {
+        v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), spread);
+        v = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040)),
+                         _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010)));
+        _mm_storeu_si128((__m128i *) o, b64_translate_ssse3(v));
+    }
+    return ((o - out) + b64_encode_scalar(in, len, o));
+}
+
+//!
+//! The AVX2 version of b64_encode_ssse3(), 24 bytes into 32 characters per step
+//!
+//! @param[in]  in see b64_encode_scalar()
+//! @param[in]  len see b64_encode_scalar()
+//! @param[out] out see b64_encode_scalar()
+//!
+//! @return see b64_encode_scalar()
+//!
+__attribute__ ((target("avx2")))
+static size_t b64_encode_avx2(const u8 * in, size_t len, char *out)
+{
+    char *o = out;
+    __m256i v = _mm256_setzero_si256();
+    __m256i result = _mm256_setzero_si256();
+    __m256i less = _mm256_setzero_si256();
+    const __m256i spread = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1, 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i shift_lut = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                               'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    for (; len >= 32; len -= 24, in += 24, o += 32) {
+        v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)), _mm_loadu_si128((const __m128i *)(in + 12)), 1);
+        v = _mm256_shuffle_epi8(v, spread);
+        v = _mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040)),
+                            _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010)));
+        result = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+        less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i *) o, _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), v));
+    }
+    return ((o - out) + b64_encode_ssse3(in, len, o));
+}
+
+//!
+//! Decodes 16 characters into 12 bytes per step with SSSE3. Two nibble lookups flag every
+//! character outside of the alphabet, which hands the rest of the text (padding, whitespace
+//! or an error) to the scalar code. Multiply-adds then pack the 6-bit values together.
+//!
+//! @param[in]  in see b64_decode_scalar()
+//! @param[in]  len see b64_decode_scalar()
+//! @param[out] out see b64_decode_scalar()
+//! @param[out] pOutLen see b64_decode_scalar()
+//!
+//! @return see b64_decode_scalar()
+//!
+__attribute__ ((target("ssse3")))
+static int b64_decode_ssse3(const char *in, size_t len, u8 * out, size_t * pOutLen)
+{
+    int rc = 0;
+    u8 *o = out;
+    size_t tail = 0;
+    __m128i v = _mm_setzero_si128();
+    __m128i hi_nibbles = _mm_setzero_si128();
+    __m128i flags = _mm_setzero_si128();
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // 24 characters left guarantee room for the 16 bytes stored per step
+    for (; len >= 24; len -= 16, in += 16, o += 12) {
+        v = _mm_loadu_si128((const __m128i *)in);
+        hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), _mm_set1_epi8(0x0F));
+        flags = _mm_and_si128(_mm_shuffle_epi8(lut_lo, _mm_and_si128(v, _mm_set1_epi8(0x0F))), _mm_shuffle_epi8(lut_hi, hi_nibbles));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(flags, _mm_setzero_si128())) != 0xFFFF)
+            break;
+
+        v = _mm_add_epi8(v, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), hi_nibbles)));
+        v = _mm_madd_epi16(_mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *) o, _mm_shuffle_epi8(v, pack));
+    }
+
+    if ((rc = b64_decode_scalar(in, len, o, &tail)) == EUCA_OK)
+        *pOutLen = (o - out) + tail;
+    return (rc);
+}
+
+//!
+//! The AVX2 version of b64_decode_ssse3(), 32 characters into 24 bytes per step
+//!
+//! @param[in]  in see b64_decode_scalar()
+//! @param[in]  len see b64_decode_scalar()
+//! @param[out] out see b64_decode_scalar()
+//! @param[out] pOutLen see b64_decode_scalar()
+//!
+//! @return see b64_decode_scalar()
+//!
+__attribute__ ((target("avx2")))
+static int b64_decode_avx2(const char *in, size_t len, u8 * out, size_t * pOutLen)
+{
+    int rc = 0;
+    u8 *o = out;
+    size_t tail = 0;
+    __m256i v = _mm256_setzero_si256();
+    __m256i hi_nibbles = _mm256_setzero_si256();
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    // 48 characters left guarantee room for the 32 bytes stored per step
+    for (; len >= 48; len -= 32, in += 32, o += 24) {
+        v = _mm256_loadu_si256((const __m256i *)in);
+        hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), _mm256_set1_epi8(0x0F));
+        if (!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, _mm256_and_si256(v, _mm256_set1_epi8(0x0F))), _mm256_shuffle_epi8(lut_hi, hi_nibbles)))
+            break;
+
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')), hi_nibbles)));
+        v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i *) o, v);
+    }
+
+    if ((rc = b64_decode_ssse3(in, len, o, &tail)) == EUCA_OK)
+        *pOutLen = (o - out) + tail;
+    return (rc);
+}
+
+//!
+//! Writes the hex digits of 16 bytes per step with SSSE3: a shuffle looks up the digit of
+//! each nibble, and unpacking interleaves the high and low ones
+//!
+//! @param[in]  in see hex_encode_scalar()
+//! @param[in]  len see hex_encode_scalar()
+//! @param[out] out see hex_encode_scalar()
+//!
+__attribute__ ((target("ssse3")))
+static void hex_encode_ssse3(const u8 * in, size_t len, char *out)
+{
+    __m128i v = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    __m128i lo = _mm_setzero_si128();
+    const __m128i digits = _mm_loadu_si128((const __m128i *)hex_digits);
+
+    for (; len >= 16; len -= 16, in += 16, out += 32) {
+        v = _mm_loadu_si128((const __m128i *)in);
+        hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F)));
+        lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, _mm_set1_epi8(0x0F)));
+        _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    hex_encode_scalar(in, len, out);
+}
+#endif /* EUCA_SIMD_X86 */
+
+#ifdef EUCA_SIMD_NEON
+//!
+//! Encodes 48 bytes into 64 characters per step with NEON. The structured loads and stores
+//! do the (de)interleaving, and a 64-entry table lookup maps indices to characters.
+//!
+//! @param[in]  in see b64_encode_scalar()
+//! @param[in]  len see b64_encode_scalar()
+//! @param[out] out see b64_encode_scalar()
+//!
+//! @return see b64_encode_scalar()
+//!
+static size_t b64_encode_neon(const u8 * in, size_t len, char *out)
+{
+    char *o = out;
+    uint8x16x3_t src;
+    uint8x16x4_t dst;
+    uint8x16x4_t table = vld1q_u8_x4((const u8 *)b64_chars);
+
+    for (; len >= 48; len -= 48, in += 48, o += 64) {
+        src = vld3q_u8(in);
+        dst.val[0] = vshrq_n_u8(src.val[0], 2);
+        dst.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(src.val[1], 4), vshlq_n_u8(src.val[0], 4)), vdupq_n_u8(0x3F));
+        dst.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(src.val[2], 6), vshlq_n_u8(src.val[1], 2)), vdupq_n_u8(0x3F));
+        dst.val[3] = vandq_u8(src.val[2], vdupq_n_u8(0x3F));
+        dst.val[0] = vqtbl4q_u8(table, dst.val[0]);
+        dst.val[1] = vqtbl4q_u8(table, dst.val[1]);
+        dst.val[2] = vqtbl4q_u8(table, dst.val[2]);
+        dst.val[3] = vqtbl4q_u8(table, dst.val[3]);
+        vst4q_u8((u8 *) o, dst);
+    }
+    return ((o - out) + b64_encode_scalar(in, len, o));
+}
+
+//!
+//! Writes the hex digits of 16 bytes per step with NEON
+//!
+//! @param[in]  in see hex_encode_scalar()
+//! @param[in]  len see hex_encode_scalar()
+//! @param[out] out see hex_encode_scalar()
+//!
+static void hex_encode_neon(const u8 * in, size_t len, char *out)
+{
+    uint8x16_t v;
+    uint8x16x2_t dst;
+    uint8x16_t digits = vld1q_u8((const u8 *)hex_digits);
+
+    for (; len >= 16; len -= 16, in += 16, out += 32) {
+        v = vld1q_u8(in);
+        dst.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(v, 4));
+        dst.val[1] = vqtbl1q_u8(digits, vandq_u8(v, vdupq_n_u8(0x0F)));
+        vst2q_u8((u8 *) out, dst);
+    }
+    hex_encode_scalar(in, len, out);
+}
+#endif /* EUCA_SIMD_NEON */
+
+//!
+//! Picks the fastest codecs the CPU supports
+//!
+static void codecs_init(void)
+{
+    memset(b64_values, B64_INVALID, sizeof(b64_values));
+    for (int i = 0; i < 64; i++)
+        b64_values[(u8) b64_chars[i]] = i;
+    b64_values['='] = B64_PAD;
+    b64_values[' '] = b64_values['\t'] = b64_values['\r'] = b64_values['\n'] = B64_SPACE;
+
+#ifdef EUCA_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        b64_encode_fn = b64_encode_avx2;
+        b64_decode_fn = b64_decode_avx2;
+        hex_encode_fn = hex_encode_ssse3;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        b64_encode_fn = b64_encode_ssse3;
+        b64_decode_fn = b64_decode_ssse3;
+        hex_encode_fn = hex_encode_ssse3;
+    }
+#endif /* EUCA_SIMD_X86 */
+#ifdef EUCA_SIMD_NEON
+    b64_encode_fn = b64_encode_neon;
+    hex_encode_fn = hex_encode_neon;
+#endif /* EUCA_SIMD_NEON */
+}
+
+//!
+//! Encodes data to base64, without line breaks, with the fastest code the CPU supports
+//!
+//! @param[in]  in the data
+//! @param[in]  len its length
+//! @param[out] out room for EUCA_BASE64_ENCODED_LEN(len) + 1 characters
+//!
+//! @return the length of the NUL-terminated text written to out
+//!
+size_t euca_base64_encode(const u8 * in, size_t len, char *out)
+{
+    size_t written = 0;
+
+    pthread_once(&codecs_once, codecs_init);
+    written = b64_encode_fn(in, len, out);
+    out[written] = '\0';
+    return (written);
+}
+
+//!
+//! Decodes base64 with the fastest code the CPU supports. Whitespace is skipped and padding
+//! is optional.
+//!
+//! @param[in]  in the base64 text
+//! @param[in]  len its length
+//! @param[out] out room for EUCA_BASE64_DECODED_MAX(len) bytes
+//! @param[out] pOutLen set to the number of bytes written
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the text is not valid base64
+//!
+int euca_base64_decode(const char *in, size_t len, u8 * out, size_t * pOutLen)
+{
+    pthread_once(&codecs_once, codecs_init);
+    return (b64_decode_fn(in, len, out, pOutLen));
+}
+
+//!
+//! Writes the lowercase hex digits of data with the fastest code the CPU supports
+//!
+//! @param[in]  in the data
+//! @param[in]  len its length
+//! @param[out] out room for (len * 2) + 1 characters
+//!
+void euca_hex_encode(const u8 * in, size_t len, char *out)
+{
+    pthread_once(&codecs_once, codecs_init);
+    hex_encode_fn(in, len, out);
+    out[len * 2] = '\0';
+}
+
 //!
 //! Encode a given buffer
 //!
@@ -963,75 +1411,43 @@ char *euca_get_cert(u8 options)
 //!
 char *base64_enc(u8 * sIn, int size)
 {
-    BIO *pBio64 = NULL;
-    BIO *pBioMem = NULL;
     char *sEncVal = NULL;
-    BUF_MEM *pBuffer = NULL;
 
     if ((sIn != NULL) && (size > 0)) {
-        if ((pBio64 = BIO_new(BIO_f_base64())) == NULL) {
-            LOGERROR("BIO_new(BIO_f_base64()) failed\n");
+        if ((sEncVal = EUCA_ALLOC((EUCA_BASE64_ENCODED_LEN(size) + 1), sizeof(char))) == NULL) {
+            LOGERROR("out of memory for Base64 buf\n");
         } else {
-            BIO_set_flags(pBio64, BIO_FLAGS_BASE64_NO_NL);  // no long-line wrapping
-            if ((pBioMem = BIO_new(BIO_s_mem())) == NULL) {
-                LOGERROR("BIO_new(BIO_s_mem()) failed\n");
-            } else {
-                pBio64 = BIO_push(pBio64, pBioMem);
-                if (BIO_write(pBio64, sIn, size) != size) {
-                    LOGERROR("BIO_write() failed\n");
-                } else {
-                    (void)BIO_flush(pBio64);
-                    BIO_get_mem_ptr(pBio64, &pBuffer);
-                    if ((sEncVal = EUCA_ALLOC((pBuffer->length + 1), sizeof(char))) == NULL) {
-                        LOGERROR("out of memory for Base64 buf\n");
-                    } else {
-                        memcpy(sEncVal, pBuffer->data, pBuffer->length);
-                        sEncVal[pBuffer->length] = '\0';
-                    }
-                }
-            }
-
-            BIO_free_all(pBio64);      // frees both bio64 and biomem
+            euca_base64_encode(sIn, size, sEncVal);
         }
     }
     return (sEncVal);
 }
 
 //!
+//! Decode a given buffer
 //!
+//! @param[in]  sIn a pointer to the string buffer to decode
+//! @param[in]  size the length of the string buffer
+//! @param[out] decoded_length set to the number of decoded bytes
 //!
-//! @param[in] sIn
-//! @param[in] size
-//! @param[in] decoded_length
+//! @return a pointer to the decoded, NUL terminated, buffer or NULL if it does not decode to anything
 //!
-//! @return
+//! @note caller must free the returned string
 //!
 char *base64_dec2(u8 * sIn, int size, int *decoded_length)
 {
-    BIO *pBio64 = NULL;
-    BIO *pBioMem = NULL;
+    size_t len = 0;
     char *sBuffer = NULL;
 
     if ((sIn != NULL) && (size > 0)) {
-        if ((pBio64 = BIO_new(BIO_f_base64())) == NULL) {
-            LOGERROR("BIO_new(BIO_f_base64()) failed\n");
+        if ((sBuffer = EUCA_ZALLOC((EUCA_BASE64_DECODED_MAX(size) + 1), sizeof(char))) == NULL) {
+            LOGERROR("Memory allocation failure.\n");
+        } else if ((euca_base64_decode((const char *)sIn, size, (u8 *) sBuffer, &len) != EUCA_OK) || (len == 0)) {
+            LOGERROR("base64 decoding failed\n");
+            EUCA_FREE(sBuffer);
         } else {
-            BIO_set_flags(pBio64, BIO_FLAGS_BASE64_NO_NL);  /* no long-line wrapping */
-
-            if ((pBioMem = BIO_new_mem_buf(sIn, size)) == NULL) {
-                LOGERROR("BIO_new_mem_buf() failed\n");
-            } else if ((sBuffer = EUCA_ZALLOC(size, sizeof(char))) == NULL) {
-                LOGERROR("Memory allocation failure.\n");
-            } else {
-                pBioMem = BIO_push(pBio64, pBioMem);
-
-                if ((*decoded_length = BIO_read(pBioMem, sBuffer, size)) <= 0) {
-                    LOGERROR("BIO_read() read failed\n");
-                    EUCA_FREE(sBuffer);
-                }
-            }
-
-            BIO_free_all(pBio64);
+            sBuffer[len] = '\0';
+            *decoded_length = len;
         }
     }
 
@@ -1054,34 +1470,8 @@ char *base64_dec2(u8 * sIn, int size, int *decoded_length)
 //!
 char *base64_dec(u8 * sIn, int size)
 {
-    BIO *pBio64 = NULL;
-    BIO *pBioMem = NULL;
-    char *sBuffer = NULL;
-
-    if ((sIn != NULL) && (size > 0)) {
-        if ((pBio64 = BIO_new(BIO_f_base64())) == NULL) {
-            LOGERROR("BIO_new(BIO_f_base64()) failed\n");
-        } else {
-            BIO_set_flags(pBio64, BIO_FLAGS_BASE64_NO_NL);  /* no long-line wrapping */
-
-            if ((pBioMem = BIO_new_mem_buf(sIn, size)) == NULL) {
-                LOGERROR("BIO_new_mem_buf() failed\n");
-            } else if ((sBuffer = EUCA_ZALLOC(size, sizeof(char))) == NULL) {
-                LOGERROR("Memory allocation failure.\n");
-            } else {
-                pBioMem = BIO_push(pBio64, pBioMem);
-
-                if ((BIO_read(pBioMem, sBuffer, size)) <= 0) {
-                    LOGERROR("BIO_read() read failed\n");
-                    EUCA_FREE(sBuffer);
-                }
-            }
-
-            BIO_free_all(pBio64);
-        }
-    }
-
-    return (sBuffer);
+    int len = 0;
+    return (base64_dec2(sIn, size, &len));
 }
 
 //!
@@ -1102,7 +1492,6 @@ char *base64_dec(u8 * sIn, int size)
 //!
 char *hexify(unsigned char *data, int data_len)
 {
-    int i = 0;
     char *hex_str = NULL;
 
     if (data == NULL)
@@ -1114,47 +1503,25 @@ char *hexify(unsigned char *data, int data_len)
         return (NULL);
     }
 
-    for (i = 0; i < data_len; i++) {
-        hex_str[i * 2] = hex_digits[(data[i] / 16)];
-        hex_str[i * 2 + 1] = hex_digits[(data[i] % 16)];
-    }
-
-    hex_str[data_len * 2] = '\0';      //make sure it's null terminated
+    euca_hex_encode(data, data_len, hex_str);
     return (hex_str);
 }
 
 //!
-//!
+//! Calculates the MD5 fingerprint of a certificate. The certificate is parsed and its fingerprint
+//! computed once, then again only when the file changes.
 //!
 //! @param[in] cert_filename
 //!
-//! @return
-//!
-//! @see
-//!
-//! @pre
-//!
-//! @post
+//! @return a new hex string of the fingerprint or NULL on error
 //!
-//! @note
+//! @note caller must free the returned string
 //!
 char *calc_fingerprint(const char *cert_filename)
 {
-#define MD5_FINGERPRINT_SIZE        16
-
-    u8 *cert_buffer = NULL;            // read buffer for certificate
-    int fd = 0;                        // file descriptor for reading cert file
-    int read_size = 0;
-    int err;
-    u32 n = 0;
-    char errmsg[1024] = "";
     char *fingerprint_str = NULL;
-    u8 fingerprint[EVP_MAX_MD_SIZE] = { 0 };
-    ssize_t file_buffer_size = 0;      // size of read buffer
-    BIO *bio = NULL;
-    X509 *x509_cert = NULL;
-    struct stat cert_file_stats = { 0 };    // file stat structure for getting the size of the file
-    const EVP_MD *digest_function = NULL;   // digest of the cert
+    const char *fingerprint = NULL;
+    crypto_file *file = NULL;
 
     if (!initialized) {
         if (euca_init_cert() != EUCA_OK) {
@@ -1166,75 +1533,19 @@ char *calc_fingerprint(const char *cert_filename)
         LOGERROR("got a null filename, returning null");
         return (NULL);
     }
-    // Check the file and get the file size for allocation of buffers
-    if (stat(cert_filename, &cert_file_stats) == -1) {
-        LOGERROR("error in stat() of %s\n", cert_filename);
-        return (NULL);
-    }
-    //! @TODO: can this be removed?
-    // double the byte-count, for extra
-    file_buffer_size = cert_file_stats.st_size * 2;
-    if ((cert_buffer = EUCA_ZALLOC(file_buffer_size, sizeof(u8))) == NULL) {
-        LOGERROR("could not allocate memory to read certificate file for fingerprint calculation\n");
-        return (NULL);
-    }
-
-    if ((fd = open(cert_filename, O_RDONLY)) == -1) {
-        LOGERROR("could not open %s to read certificate for fingerprint calculation\n", cert_filename);
-        EUCA_FREE(cert_buffer);
-        return (NULL);
-    }
-    //Read in the file, the whole thing
-    if ((read_size = read(fd, cert_buffer, file_buffer_size)) == -1) {
-        LOGERROR("error reading certificate file %s\n", sCertFileName);
-        EUCA_FREE(cert_buffer);
-        close(fd);
-        return (NULL);
-    }
-    close(fd);
 
-    // create a BIO buffer for the cert contents
-    bio = BIO_new_mem_buf(cert_buffer, read_size);
-
-    // decode buffer
-    if ((x509_cert = PEM_read_bio_X509(bio, NULL, 0L, NULL)) == NULL) {
-        // Construct an error message
-        while ((err = ERR_get_error()) != 0) {
-            errmsg[1023] = '\0';
-            ERR_error_string_n(err, errmsg, 1023);
-            LOGERROR("PEM_read_bio_x509 error message: %s\n", errmsg);
+    pthread_mutex_lock(&crypto_files_mutex);
+    {
+        if ((file = crypto_file_get(cert_filename, TRUE)) == NULL) {
+            LOGERROR("could not read certificate file %s for fingerprint calculation\n", cert_filename);
+        } else if ((fingerprint = crypto_file_fingerprint(file)) == NULL) {
+            LOGERROR("calc_fingerprint: could not calculate the fingerprint of %s. Returning null\n", cert_filename);
+        } else if ((fingerprint_str = strdup(fingerprint)) == NULL) {
+            LOGERROR("out of memory\n");
         }
-
-        BIO_free(bio);
-        X509_free(x509_cert);
-        EUCA_FREE(cert_buffer);
-        return (NULL);
-    }
-    // calculate fingerprint, first get digest
-    digest_function = EVP_get_digestbyname("md5");
-
-    // allocate the fingerprint buffer
-    if (!X509_digest(x509_cert, digest_function, fingerprint, &n)) {
-        LOGERROR("X509 digest failed.");
-        BIO_free(bio);
-        X509_free(x509_cert);
-        EUCA_FREE(cert_buffer);
-        return (NULL);
-    }
-
-    BIO_free(bio);
-    X509_free(x509_cert);
-    EUCA_FREE(cert_buffer);
-
-    // Get the hex string of the digest
-    if ((fingerprint_str = hexify(fingerprint, MD5_FINGERPRINT_SIZE)) == NULL) {
-        // malloc failed or something broke
-        LOGERROR("calc_fingerprint: hexify returned null. Cleaning up and returning null");
     }
-
+    pthread_mutex_unlock(&crypto_files_mutex);
     return (fingerprint_str);
-
-#undef MD5_FINGERPRINT_SIZE
 }
 
 //!
@@ -1293,79 +1604,101 @@ void free_key_value_pair_array(struct key_value_pair_array *kv_array)
 }
 
 //!
+//! Finds the name and the value of a "name: value" header, skipping the spaces around both
 //!
+//! @param[in]  header_str
+//! @param[in]  delimiter
+//! @param[out] pNameStart offset of the name
+//! @param[out] pNameLen length of the name
+//! @param[out] pValueStart offset of the value
+//! @param[out] pValueLen length of the value
 //!
-//! @param[in] header_str
-//! @param[in] delimiter
-//!
-//! @return
-//!
-//! @see
-//!
-//! @pre
-//!
-//! @post
-//!
-//! @note
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the header has no colon after its name
 //!
-struct key_value_pair *deconstruct_header(const char *header_str, char delimiter)
+static int split_header(const char *header_str, char delimiter, size_t * pNameStart, size_t * pNameLen, size_t * pValueStart, size_t * pValueLen)
 {
     int j = 0;
     size_t i = 0;
-    size_t value_start = 0;
     size_t src_len = 0;
-    size_t name_start = 0;
-    size_t name_len = 0;
-    size_t value_len = 0;
-    char *name_str = NULL;
-    char *value_str = NULL;
     char delim_string[3] = { ' ', delimiter, '\0' };
-    struct key_value_pair *header = NULL;
-
-    if (header_str == NULL) {
-        LOGDEBUG("Tried to convert null header to header struct. Returning empty struct.");
-        return (NULL);
-    }
 
     src_len = strlen(header_str);
     i = strspn(header_str, " ");       //get any initial space padding
 
     //Get the header name
-    name_start = i;
+    *pNameStart = i;
 
     //find the next space or colon, denotes end of header name
     i += strcspn(&(header_str[i]), delim_string);
-    name_len = i - name_start;
-    if ((name_str = (char *)EUCA_ZALLOC((name_len + 1), sizeof(char))) == NULL) {
-        LOGERROR("failed to allocate memory for the header name string. Returning null");
-        return (NULL);
-    }
-    //copy the name into new buffer
-    strncpy(name_str, &(header_str[name_start]), name_len);
-
-    //convert header name to all lowercase
-    for (j = 0; j < name_len; j++) {
-        name_str[j] = tolower(name_str[j]);
-    }
+    *pNameLen = i - *pNameStart;
 
     // skip any spaces after name but before ':'
     i += strspn(&(header_str[i]), " ");
     if (header_str[i] != ':') {
         // Format error, expected the ':' here, none found
         LOGERROR("malformed header did not find colon where expected in header= %s\n", header_str);
-        EUCA_FREE(name_str);
-        return (NULL);
+        return (EUCA_INVALID_ERROR);
     }
     // skip the colon itself
     i++;
 
     i += strspn(&(header_str[i]), " "); //skip remaining spaces after colon before value starts
-    value_start = i;
+    *pValueStart = i;
 
     //find the last non-space char, skipping '\0'
-    for (j = src_len - 1; (((header_str[j] == '\0') || (header_str[j] == ' ')) && (j > value_start)); j--) ;
+    for (j = src_len - 1; (((header_str[j] == '\0') || (header_str[j] == ' ')) && (j > *pValueStart)); j--) ;
+
+    *pValueLen = j + 1 - *pValueStart;
+    return (EUCA_OK);
+}
+
+//!
+//!
+//!
+//! @param[in] header_str
+//! @param[in] delimiter
+//!
+//! @return
+//!
+//! @see
+//!
+//! @pre
+//!
+//! @post
+//!
+//! @note
+//!
+struct key_value_pair *deconstruct_header(const char *header_str, char delimiter)
+{
+    int j = 0;
+    size_t value_start = 0;
+    size_t name_start = 0;
+    size_t name_len = 0;
+    size_t value_len = 0;
+    char *name_str = NULL;
+    char *value_str = NULL;
+    struct key_value_pair *header = NULL;
+
+    if (header_str == NULL) {
+        LOGDEBUG("Tried to convert null header to header struct. Returning empty struct.");
+        return (NULL);
+    }
+
+    if (split_header(header_str, delimiter, &name_start, &name_len, &value_start, &value_len) != EUCA_OK)
+        return (NULL);
+
+    if ((name_str = (char *)EUCA_ZALLOC((name_len + 1), sizeof(char))) == NULL) {
+        LOGERROR("failed to allocate memory for the header name string. Returning null");
+        return (NULL);
+    }
+    //copy the name into new buffer
+    strncpy(name_str, &(header_str[name_start]), name_len);
+
+    //convert header name to all lowercase
+    for (j = 0; j < name_len; j++) {
+        name_str[j] = tolower(name_str[j]);
+    }
 
-    value_len = j + 1 - value_start;
     if ((value_str = (char *)EUCA_ZALLOC((value_len + 1), sizeof(char))) == NULL) {
         EUCA_FREE(name_str);
         LOGERROR("failed to allocate memory for the header value string. Returning null");
@@ -1780,144 +2113,566 @@ char *construct_signed_headers(struct key_value_pair_array *hdr_array)
 }
 
 //!
+//! Allocates from an arena, aligned for pointers
 //!
+//! @param[in] arena
+//! @param[in] size
 //!
-//! @param[in] verb
-//! @param[in] url
-//! @param[in] headers
-//!
-//! @return
+//! @return the allocated space, or NULL if the arena is full
 //!
-//! @see
+static char *arena_alloc(sign_arena * arena, size_t size)
+{
+    char *ptr = NULL;
+    size_t start = (arena->used + (sizeof(void *) - 1)) & ~(sizeof(void *) - 1);
+
+    if ((start > arena->size) || (size > (arena->size - start)))
+        return (NULL);
+
+    ptr = arena->base + start;
+    arena->used = start + size;
+    return (ptr);
+}
+
 //!
-//! @pre
+//! Copies a string into an arena
 //!
-//! @post
+//! @param[in] arena
+//! @param[in] str
+//! @param[in] len number of characters of str to copy
 //!
-//! @note
+//! @return the NUL-terminated copy, or NULL if the arena is full
 //!
-char *eucav2_sign_request(const char *verb, const char *url, const struct curl_slist *headers)
+static char *arena_strndup(sign_arena * arena, const char *str, size_t len)
 {
-#define BUFSIZE           2024
+    char *copy = NULL;
 
-    u8 *sig = NULL;
-    RSA *rsa = NULL;
-    FILE *fp = NULL;
-    u32 siglen = 0;
-    int ret = 0;
-    char *auth_header = NULL;
-    char *canonical_uri = NULL;
-    char *canonical_query = NULL;
-    char *canonical_headers = NULL;
+    if ((copy = arena_alloc(arena, (len + 1))) != NULL) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return (copy);
+}
+
+//!
+//! Builds the canonical request of eucav2_sign_request() in an arena, with a single pass of the
+//! URL regex and no heap allocations. The result is the same as putting together the output of
+//! construct_canonical_uri(), construct_canonical_query(), construct_canonical_headers() and
+//! construct_signed_headers().
+//!
+//! @param[in]  arena where all strings are allocated
+//! @param[in]  verb
+//! @param[in]  url
+//! @param[in]  headers
+//! @param[out] pSignedHeaders set to the signed headers list, in the arena
+//!
+//! @return the canonical request, in the arena, or NULL if a header is malformed or the arena is full
+//!
+static char *canonicalize_request(sign_arena * arena, const char *verb, const char *url, const struct curl_slist *headers, char **pSignedHeaders)
+{
+    int i = 0;
+    int nhdrs = 0;
+    int nparams = 0;
+    char *p = NULL;
+    char *request = NULL;
     char *signed_headers = NULL;
-    char *cert_fingerprint = NULL;
-    char *sig_str = NULL;
-    char canonical_request[BUFSIZE] = "";
-    u8 sha256[SHA256_DIGEST_LENGTH] = { 0 };
-    struct key_value_pair_array *hdr_array = NULL;
+    const char *query = NULL;
+    const char *path = "/";
+    const char *token = NULL;
+    const char *token_end = NULL;
+    const char *equal = NULL;
+    size_t j = 0;
+    size_t len = 0;
+    size_t name_start = 0;
+    size_t name_len = 0;
+    size_t value_start = 0;
+    size_t value_len = 0;
+    size_t path_len = 1;
+    size_t query_len = 0;
+    size_t headers_len = 0;
+    size_t signed_len = 0;
+    size_t query_out_len = 0;
+    regmatch_t matches[URL_MATCHES] = { {0} };
+    const struct curl_slist *h = NULL;
+    struct key_value_pair **hdrs = NULL;
+    struct key_value_pair **params = NULL;
+
+    // headers, lowercased and sorted
+    for (h = headers; h != NULL; h = h->next)
+        nhdrs++;
+    if ((hdrs = (struct key_value_pair **)arena_alloc(arena, (nhdrs * sizeof(struct key_value_pair *)))) == NULL)
+        return (NULL);
 
-    if (!initialized) {
-        if (euca_init_cert() != EUCA_OK) {
+    for (h = headers, i = 0; h != NULL; h = h->next, i++) {
+        if (split_header(h->data, ':', &name_start, &name_len, &value_start, &value_len) != EUCA_OK)
             return (NULL);
-        }
+        if (((hdrs[i] = (struct key_value_pair *)arena_alloc(arena, sizeof(struct key_value_pair))) == NULL)
+            || ((hdrs[i]->key = arena_strndup(arena, (h->data + name_start), name_len)) == NULL)
+            || ((hdrs[i]->value = arena_strndup(arena, (h->data + value_start), value_len)) == NULL))
+            return (NULL);
+
+        for (j = 0; j < name_len; j++)
+            hdrs[i]->key[j] = tolower(hdrs[i]->key[j]);
+        headers_len += name_len + value_len + 2;
+        signed_len += name_len + 1;
     }
+    qsort(hdrs, nhdrs, sizeof(struct key_value_pair *), compare_keys);
 
-    if ((verb == NULL) || (url == NULL) || (headers == NULL))
+    // path and query string, from one match of the URL
+    init_url_regex();
+    if (uri_regex == NULL) {
+        LOGERROR("could not get initialized regex for urls\n");
         return (NULL);
+    }
 
-    if ((hdr_array = convert_header_list_to_array(headers, ':')) == NULL) {
-        LOGERROR("failed to create http header array from list.\n");
+    if (regexec(uri_regex, url, URL_MATCHES, matches, 0) == 0) {
+        if (matches[URL_PATH].rm_eo > matches[URL_PATH].rm_so) {
+            path = url + matches[URL_PATH].rm_so;
+            path_len = matches[URL_PATH].rm_eo - matches[URL_PATH].rm_so;
+        }
+        if (matches[URL_QUERY].rm_eo > matches[URL_QUERY].rm_so) {
+            query = url + matches[URL_QUERY].rm_so;
+            query_len = matches[URL_QUERY].rm_eo - matches[URL_QUERY].rm_so;
+        }
     }
-    // Prepare the components of the canonical request
-    if ((canonical_uri = construct_canonical_uri(url)) == NULL) {
-        LOGERROR("Cannot sign request, got null canonical_uri, probably out of memory\n");
+
+    // query parameters, as "key=value" and sorted by key
+    for (j = 0; j < query_len; j++) {
+        if (query[j] == '&')
+            nparams++;
     }
+    if ((query_len > 0) && ((params = (struct key_value_pair **)arena_alloc(arena, ((nparams + 1) * sizeof(struct key_value_pair *)))) == NULL))
+        return (NULL);
 
-    if ((canonical_query = construct_canonical_query(url)) == NULL) {
-        LOGERROR("Cannot sign request, got null canonical_query, probably out of memory\n");
+    for (token = query, nparams = 0; (token != NULL) && (token < (query + query_len)); token = token_end + 1) {
+        if ((token_end = memchr(token, '&', ((query + query_len) - token))) == NULL)
+            token_end = query + query_len;
+        if (token_end == token)
+            continue;
+
+        if ((equal = memchr(token, '=', (token_end - token))) == NULL)
+            equal = token_end;
+        if (((params[nparams] = (struct key_value_pair *)arena_alloc(arena, sizeof(struct key_value_pair))) == NULL)
+            || ((params[nparams]->key = arena_strndup(arena, token, (equal - token))) == NULL)
+            || ((params[nparams]->value = arena_strndup(arena, ((equal < token_end) ? (equal + 1) : token_end), (token_end - ((equal < token_end) ? (equal + 1) : token_end)))) == NULL))
+            return (NULL);
+        query_out_len += (token_end - token) + ((equal == token_end) ? 2 : 1);
+        nparams++;
     }
+    if (nparams > 0)
+        qsort(params, nparams, sizeof(struct key_value_pair *), compare_keys);
+
+    len = strlen(verb) + path_len + query_out_len + headers_len + signed_len + 4;
+    if (((request = arena_alloc(arena, (len + 1))) == NULL) || ((signed_headers = arena_alloc(arena, (signed_len + 1))) == NULL))
+        return (NULL);
+
+#define APPEND(_p, _s, _n)  { memcpy((_p), (_s), (_n)); (_p) += (_n); }
+#define APPEND_STR(_p, _s)  APPEND((_p), (_s), strlen(_s))
+
+    p = request;
+    APPEND_STR(p, verb);
+    *(p++) = '\n';
+    APPEND(p, path, path_len);
+    *(p++) = '\n';
+    for (i = 0; i < nparams; i++) {
+        APPEND_STR(p, params[i]->key);
+        *(p++) = '=';
+        APPEND_STR(p, params[i]->value);
+        *(p++) = '&';
+    }
+    if (nparams > 0)
+        p--;                           // drop the last '&'
+    *(p++) = '\n';
+    for (i = 0; i < nhdrs; i++) {
+        APPEND_STR(p, hdrs[i]->key);
+        *(p++) = ':';
+        APPEND_STR(p, hdrs[i]->value);
+        *(p++) = '\n';
+    }
+    if (nhdrs > 0)
+        p--;                           // drop the last newline
+    *(p++) = '\n';
+
+    signed_headers[0] = '\0';
+    for (i = 0, signed_len = 0; i < nhdrs; i++) {
+        len = strlen(hdrs[i]->key);
+        memcpy(signed_headers + signed_len, hdrs[i]->key, len);
+        signed_len += len;
+        signed_headers[signed_len++] = ';';
+    }
+    if (signed_len > 0)
+        signed_len--;                  // drop the last ';'
+    signed_headers[signed_len] = '\0';
+
+    APPEND(p, signed_headers, signed_len);
+    *p = '\0';
+
+#undef APPEND
+#undef APPEND_STR
+
+    *pSignedHeaders = signed_headers;
+    return (request);
+}
 
-    if ((canonical_headers = construct_canonical_headers(hdr_array)) == NULL) {
-        LOGERROR("Cannot sign request, got null canonical_headers, probably out of memory\n");
+//!
+//! Tells whether two stat() results are of the same, unmodified, file
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return TRUE if they are or FALSE otherwise
+//!
+static boolean same_file(const struct stat *a, const struct stat *b)
+{
+    return ((a->st_dev == b->st_dev) && (a->st_ino == b->st_ino) && (a->st_size == b->st_size) && (a->st_mtime == b->st_mtime));
+}
+
+//!
+//! Releases what a slot of crypto_files[] holds and frees the slot
+//!
+//! @param[in] file the slot
+//!
+static void crypto_file_clear(crypto_file * file)
+{
+    // threads still using a key or a context over it hold their own reference to it
+    if (file->pkey != NULL)
+        EVP_PKEY_free(file->pkey);
+    if (file->cert != NULL)
+        X509_free(file->cert);
+    EUCA_FREE(file->pem);
+    EUCA_FREE(file->fingerprint);
+    bzero(file, sizeof(crypto_file));
+}
+
+//!
+//! Gets a private key or certificate file, which is parsed once and then only re-read when it
+//! changes. Must be called with crypto_files_mutex held, and what it returns is only valid for
+//! as long as it is.
+//!
+//! @param[in] path the file
+//! @param[in] is_cert TRUE if it is a certificate file, FALSE if it is a private key file
+//!
+//! @return the parsed file or NULL on error
+//!
+static crypto_file *crypto_file_get(const char *path, boolean is_cert)
+{
+    int i = 0;
+    char *pem = NULL;
+    BIO *bio = NULL;
+    X509 *cert = NULL;
+    EVP_PKEY *pkey = NULL;
+    crypto_file *file = NULL;
+    struct stat st = { 0 };
+
+    if ((path == NULL) || (path[0] == '\0') || (strlen(path) >= FILENAME))
+        return (NULL);
+
+    if (stat(path, &st) != 0) {
+        LOGERROR("error, failed to stat %s file %s\n", (is_cert ? "certificate" : "private key"), path);
+        return (NULL);
     }
 
-    if ((signed_headers = construct_signed_headers(hdr_array)) == NULL) {
-        LOGERROR("Cannot sign request, got null signed_headers, probably out of memory\n");
+    for (i = 0; i < MAX_CRYPTO_FILES; i++) {
+        if ((crypto_files[i].is_cert == is_cert) && !strcmp(crypto_files[i].path, path)) {
+            file = &(crypto_files[i]);
+            if (same_file(&st, &(file->st)))
+                return (file);
+            break;
+        }
     }
 
-    if (hdr_array != NULL)
-        free_key_value_pair_array(hdr_array);
+    // the file is read after it is stat()ed, so a change in between only gets it read again next time
+    LOGTRACE("reading %s file %s\n", (is_cert ? "certificate" : "private key"), path);
+    if ((pem = file2str(path)) == NULL) {
+        LOGERROR("error, failed to read %s file %s\n", (is_cert ? "certificate" : "private key"), path);
+        return (NULL);
+    }
 
-    if ((canonical_uri == NULL) || (canonical_query == NULL) || (canonical_headers == NULL) || (signed_headers == NULL)) {
-        LOGERROR("Cannot construct canonical request due to nulls in data\n");
+    if ((bio = BIO_new_mem_buf(pem, -1)) == NULL) {
+        LOGERROR("out of memory\n");
+        EUCA_FREE(pem);
+        return (NULL);
+    }
 
-        // Free any non-null strings.
-        EUCA_FREE(canonical_uri);
-        EUCA_FREE(canonical_query);
-        EUCA_FREE(canonical_headers);
-        EUCA_FREE(signed_headers);
+    if (is_cert) {
+        if ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) == NULL) {
+            LOGERROR("error, failed to parse certificate file %s\n", path);
+        } else if ((pkey = X509_get_pubkey(cert)) == NULL) {
+            LOGERROR("error, failed to get the public key of certificate file %s\n", path);
+            X509_free(cert);
+            cert = NULL;
+        }
+    } else if ((pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL)) == NULL) {
+        LOGERROR("error, failed to parse private key file %s\n", path);
+    }
+    BIO_free(bio);
+
+    if (pkey == NULL) {
+        EUCA_FREE(pem);
         return (NULL);
     }
 
-    assert((strlen(verb) + strlen(canonical_uri) + strlen(canonical_query) + strlen(canonical_headers) + strlen(signed_headers) + 5) <= BUFSIZE);
+    if (file == NULL) {
+        for (i = 0; (i < MAX_CRYPTO_FILES) && (crypto_files[i].path[0] != '\0'); i++) ;
+        if (i == MAX_CRYPTO_FILES)
+            i = (crypto_files_next++ % MAX_CRYPTO_FILES);
+        file = &(crypto_files[i]);
+    }
+
+    crypto_file_clear(file);
+    euca_strncpy(file->path, path, FILENAME);
+    file->is_cert = is_cert;
+    file->st = st;
+    file->pem = pem;
+    file->pkey = pkey;
+    file->cert = cert;
+    return (file);
+}
 
-    snprintf(canonical_request, BUFSIZE, "%s\n%s\n%s\n%s\n%s", verb, canonical_uri, canonical_query, canonical_headers, signed_headers);
-    EUCA_FREE(canonical_uri);
-    EUCA_FREE(canonical_query);
-    EUCA_FREE(canonical_headers);
-    // Don't free signed_headers... needed later for the auth header construction
+//!
+//! Gets the MD5 fingerprint of a certificate file, computed the first time it is asked for.
+//! Must be called with crypto_files_mutex held.
+//!
+//! @param[in] file the certificate file from crypto_file_get()
+//!
+//! @return the fingerprint as a hex string or NULL on error
+//!
+static const char *crypto_file_fingerprint(crypto_file * file)
+{
+#define MD5_FINGERPRINT_SIZE        16
 
-    if ((rsa = RSA_new()) == NULL) {
-        LOGERROR("error, RSA_new() failed\n");
-    } else if ((fp = fopen(sPrivKeyFileName, "r")) == NULL) {
-        LOGERROR("error, failed to open private key file %s\n", sPrivKeyFileName);
-        RSA_free(rsa);
-    } else {
-        LOGTRACE("reading private key file %s\n", sPrivKeyFileName);
-        PEM_read_RSAPrivateKey(fp, &rsa, NULL, NULL);   /* read the PEM-encoded file into rsa struct */
-        if (rsa == NULL) {
-            LOGERROR("error, failed to read private key file %s\n", sPrivKeyFileName);
-        } else {
-            if ((cert_fingerprint = calc_fingerprint(sCertFileName)) == NULL) {
-                LOGERROR("error, failed to calculate certificate fingerprint for %s\n", sCertFileName);
-            } else {
-                // RSA_print_fp (stdout, rsa, 0); // (for debugging)
-                if ((sig = EUCA_ZALLOC(RSA_size(rsa), sizeof(u8))) == NULL) {
-                    LOGERROR("out of memory (for RSA key)\n");
-                } else {
-                    // finally, SHA256 and sign with PK
-                    LOGTRACE("signing input %s\n", get_string_stats(canonical_request));
-                    SHA256(((u8 *) canonical_request), strlen(canonical_request), sha256);
-
-                    if ((ret = RSA_sign(NID_sha256, sha256, SHA256_DIGEST_LENGTH, sig, &siglen, rsa)) != 1) {
-                        LOGDEBUG("RSA_sign() failed\n");
-                    } else {
-                        LOGTRACE("signing output %d\n", sig[siglen - 1]);
-                        sig_str = base64_enc(sig, siglen);
-                        LOGTRACE("base64 signature %s\n", get_string_stats((char *)sig_str));
-                    }
-                    EUCA_FREE(sig);
+    u32 n = 0;
+    u8 fingerprint[EVP_MAX_MD_SIZE] = { 0 };
 
-                    // create full auth header string
-                    if ((auth_header = (char *)EUCA_ZALLOC((BUFSIZE + 1), sizeof(char))) == NULL) {
-                        LOGERROR("Cannot sign object storage request, no memory for auth header string\n");
-                    } else {
-                        snprintf(auth_header, BUFSIZE, "Authorization: EUCA2-RSA-SHA256 %s %s %s", cert_fingerprint, signed_headers, sig_str);
-                    }
+    if ((file->fingerprint == NULL) && (file->cert != NULL)) {
+        if (!X509_digest(file->cert, EVP_md5(), fingerprint, &n)) {
+            LOGERROR("X509 digest failed.\n");
+        } else if ((file->fingerprint = hexify(fingerprint, MD5_FINGERPRINT_SIZE)) == NULL) {
+            LOGERROR("hexify returned null\n");
+        }
+    }
+    return (file->fingerprint);
 
-                    EUCA_FREE(sig_str);
-                }
+#undef MD5_FINGERPRINT_SIZE
+}
+
+//!
+//! Creates a context over the key of a private key or certificate file
+//!
+//! @param[in] path the file
+//! @param[in] is_cert TRUE if it is a certificate file, FALSE if it is a private key file
+//!
+//! @return a new context or NULL on error
+//!
+static EVP_PKEY_CTX *crypto_file_ctx(const char *path, boolean is_cert)
+{
+    EVP_PKEY_CTX *ctx = NULL;
+    crypto_file *file = NULL;
+
+    if (!initialized) {
+        if (euca_init_cert() != EUCA_OK) {
+            return (NULL);
+        }
+    }
+
+    pthread_mutex_lock(&crypto_files_mutex);
+    {
+        // the context holds its own reference to the key
+        if ((file = crypto_file_get(path, is_cert)) != NULL) {
+            if ((ctx = EVP_PKEY_CTX_new(file->pkey, NULL)) == NULL)
+                LOGERROR("out of memory\n");
+        }
+    }
+    pthread_mutex_unlock(&crypto_files_mutex);
+    return (ctx);
+}
+
+//!
+//! Gets a context over a private key, for decryption or signing with EVP_PKEY_decrypt() or
+//! EVP_PKEY_sign() after their init functions. The key is only read from the file again when
+//! the file changes, and a context can be initialized once and reused for many operations.
+//!
+//! @param[in] key_file the private key file, or NULL for the node private key
+//!
+//! @return a new context, which the caller must release with EVP_PKEY_CTX_free(), or NULL on error
+//!
+//! @note a context must not be used by two threads at once, and on OpenSSL releases before 1.1
+//!       private key operations on the cached keys are only thread safe through decrypt_string()
+//!
+EVP_PKEY_CTX *euca_get_key_ctx(const char *key_file)
+{
+    return (crypto_file_ctx(((key_file != NULL) ? key_file : sPrivKeyFileName), FALSE));
+}
 
-                EUCA_FREE(cert_fingerprint);
+//!
+//! Gets a context over the public key of a certificate, for encryption or verification with
+//! EVP_PKEY_encrypt() or EVP_PKEY_verify() after their init functions. See euca_get_key_ctx().
+//!
+//! @param[in] cert_file the certificate file, or NULL for the node certificate
+//!
+//! @return a new context, which the caller must release with EVP_PKEY_CTX_free(), or NULL on error
+//!
+EVP_PKEY_CTX *euca_get_cert_ctx(const char *cert_file)
+{
+    return (crypto_file_ctx(((cert_file != NULL) ? cert_file : sCertFileName), TRUE));
+}
+
+//!
+//! Decrypts with a private key. OpenSSL releases before 1.1 need locking callbacks, which are
+//! not installed, to share the blinding state of a key between threads, so decryptions are
+//! serialized on them.
+//!
+//! @param[in]     ctx the context from euca_get_key_ctx(), initialized for decryption
+//! @param[out]    out
+//! @param[in,out] outlen size of out, set to the length of the plain text
+//! @param[in]     in
+//! @param[in]     inlen
+//!
+//! @return 1 on success, like EVP_PKEY_decrypt()
+//!
+static int pkey_decrypt(EVP_PKEY_CTX * ctx, u8 * out, size_t * outlen, const u8 * in, size_t inlen)
+{
+    int ret = 0;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_lock(&crypto_files_mutex);
+    ret = EVP_PKEY_decrypt(ctx, out, outlen, in, inlen);
+    pthread_mutex_unlock(&crypto_files_mutex);
+#else /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+    ret = EVP_PKEY_decrypt(ctx, out, outlen, in, inlen);
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+    return (ret);
+}
+
+//!
+//! Gets the node private key, which is parsed once and then only re-read when its file, or the
+//! certificate file, changes
+//!
+//! @param[out] fingerprint if not NULL, set to the fingerprint of the node certificate
+//! @param[in]  fingerprint_len size of the fingerprint buffer
+//!
+//! @return a reference to the key, which the caller must release with RSA_free(), or NULL on error
+//!
+static RSA *get_node_key(char *fingerprint, size_t fingerprint_len)
+{
+    RSA *rsa = NULL;
+    crypto_file *key = NULL;
+    crypto_file *cert = NULL;
+    const char *cert_fingerprint = NULL;
+
+    pthread_mutex_lock(&crypto_files_mutex);
+    {
+        if ((key = crypto_file_get(sPrivKeyFileName, FALSE)) != NULL) {
+            if (fingerprint != NULL) {
+                if (((cert = crypto_file_get(sCertFileName, TRUE)) == NULL) || ((cert_fingerprint = crypto_file_fingerprint(cert)) == NULL)) {
+                    LOGERROR("error, failed to calculate certificate fingerprint for %s\n", sCertFileName);
+                    key = NULL;
+                } else {
+                    euca_strncpy(fingerprint, cert_fingerprint, fingerprint_len);
+                }
             }
+            if ((key != NULL) && ((rsa = EVP_PKEY_get1_RSA(key->pkey)) == NULL))
+                LOGERROR("error, private key file %s is not an RSA key\n", sPrivKeyFileName);
+        }
+    }
+    pthread_mutex_unlock(&crypto_files_mutex);
+    return (rsa);
+}
 
-            RSA_free(rsa);
+//!
+//! Signs a digest with the node private key. OpenSSL releases before 1.1 need locking callbacks,
+//! which are not installed, to share the blinding state of a key between threads, so signatures
+//! are serialized on them.
+//!
+//! @param[in]  type NID of the digest
+//! @param[in]  digest
+//! @param[in]  digest_len
+//! @param[out] sig room for RSA_size(rsa) bytes
+//! @param[out] siglen set to the length of the signature
+//! @param[in]  rsa the key from get_node_key()
+//!
+//! @return 1 on success, like RSA_sign()
+//!
+static int node_key_sign(int type, const u8 * digest, u32 digest_len, u8 * sig, u32 * siglen, RSA * rsa)
+{
+    int ret = 0;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    pthread_mutex_lock(&crypto_files_mutex);
+    ret = RSA_sign(type, digest, digest_len, sig, siglen, rsa);
+    pthread_mutex_unlock(&crypto_files_mutex);
+#else /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+    ret = RSA_sign(type, digest, digest_len, sig, siglen, rsa);
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+    return (ret);
+}
+
+//!
+//! Signs a request to object storage or the SC with the node private key
+//!
+//! @param[in] verb
+//! @param[in] url
+//! @param[in] headers
+//!
+//! @return the "Authorization:" header, or NULL on error
+//!
+//! @note caller must free the returned string
+//!
+char *eucav2_sign_request(const char *verb, const char *url, const struct curl_slist *headers)
+{
+#define BUFSIZE           2024
+
+    RSA *rsa = NULL;
+    u32 siglen = 0;
+    char *auth_header = NULL;
+    char *signed_headers = NULL;
+    char *canonical_request = NULL;
+    char cert_fingerprint[128] = "";
+    char arena_buf[SIGN_ARENA_SIZE] = "";
+    char sig_str[EUCA_BASE64_ENCODED_LEN(MAX_SIGNATURE_LEN) + 1] = "";
+    u8 sig[MAX_SIGNATURE_LEN] = { 0 };
+    u8 sha256[SHA256_DIGEST_LENGTH] = { 0 };
+    sign_arena arena = { arena_buf, sizeof(arena_buf), 0 };
+
+    if (!initialized) {
+        if (euca_init_cert() != EUCA_OK) {
+            return (NULL);
         }
+    }
+
+    if ((verb == NULL) || (url == NULL) || (headers == NULL))
+        return (NULL);
 
-        fclose(fp);
+    if ((canonical_request = canonicalize_request(&arena, verb, url, headers, &signed_headers)) == NULL) {
+        LOGERROR("Cannot construct canonical request, malformed headers or larger than %d bytes\n", SIGN_ARENA_SIZE);
+        return (NULL);
+    }
+
+    if ((rsa = get_node_key(cert_fingerprint, sizeof(cert_fingerprint))) != NULL) {
+        if (RSA_size(rsa) > MAX_SIGNATURE_LEN) {
+            LOGERROR("private key file %s holds a key larger than supported\n", sPrivKeyFileName);
+        } else {
+            // finally, SHA256 and sign with PK
+            LOGTRACE("signing input %s\n", get_string_stats(canonical_request));
+            SHA256(((u8 *) canonical_request), strlen(canonical_request), sha256);
+
+            if (node_key_sign(NID_sha256, sha256, SHA256_DIGEST_LENGTH, sig, &siglen, rsa) != 1) {
+                LOGDEBUG("RSA_sign() failed\n");
+            } else {
+                LOGTRACE("signing output %d\n", sig[siglen - 1]);
+                euca_base64_encode(sig, siglen, sig_str);
+                LOGTRACE("base64 signature %s\n", get_string_stats(sig_str));
+            }
+
+            // create full auth header string
+            if ((auth_header = (char *)EUCA_ZALLOC((BUFSIZE + 1), sizeof(char))) == NULL) {
+                LOGERROR("Cannot sign object storage request, no memory for auth header string\n");
+            } else {
+                snprintf(auth_header, BUFSIZE, "Authorization: EUCA2-RSA-SHA256 %s %s %s", cert_fingerprint, signed_headers, sig_str);
+            }
+        }
+        RSA_free(rsa);
     }
 
-    EUCA_FREE(signed_headers);
     return (auth_header);
 
 #undef BUFSIZE
@@ -1942,13 +2697,11 @@ char *euca_sign_url(const char *sVerb, const char *sDate, const char *sURL)
 {
 #define BUFSIZE                        2024
 
-    int ret = 0;
     char sInput[BUFSIZE] = "";
     char *sSignature = NULL;
     RSA *pRSA = NULL;
-    FILE *pFile = NULL;
     u32 siglen = 0;
-    u8 *sSigBuffer = NULL;
+    u8 sSigBuffer[MAX_SIGNATURE_LEN] = { 0 };
     u8 sSHA1[SHA_DIGEST_LENGTH] = "";
 
     if (!initialized) {
@@ -1960,42 +2713,26 @@ char *euca_sign_url(const char *sVerb, const char *sDate, const char *sURL)
     if ((sVerb == NULL) || (sDate == NULL) || (sURL == NULL))
         return (NULL);
 
-    if ((pRSA = RSA_new()) == NULL) {
-        LOGERROR("RSA_new() failed\n");
-    } else if ((pFile = fopen(sPrivKeyFileName, "r")) == NULL) {
-        LOGERROR("failed to open private key file %s\n", sPrivKeyFileName);
-        RSA_free(pRSA);
-    } else {
-        LOGTRACE("reading private key file %s\n", sPrivKeyFileName);
-        PEM_read_RSAPrivateKey(pFile, &pRSA, NULL, NULL);   // read the PEM-encoded file into rsa struct
-        if (pRSA == NULL) {
-            LOGERROR("failed to read private key file %s\n", sPrivKeyFileName);
+    if ((pRSA = get_node_key(NULL, 0)) != NULL) {
+        if (RSA_size(pRSA) > MAX_SIGNATURE_LEN) {
+            LOGERROR("private key file %s holds a key larger than supported\n", sPrivKeyFileName);
         } else {
-            if ((sSigBuffer = EUCA_ALLOC(RSA_size(pRSA), sizeof(u8))) == NULL) {
-                LOGERROR("out of memory (for RSA key)\n");
-            } else {
-                // finally, SHA1 and sign with PK
-                assert((strlen(sVerb) + strlen(sDate) + strlen(sURL) + 4) <= BUFSIZE);
-
-                snprintf(sInput, BUFSIZE, "%s\n%s\n%s\n", sVerb, sDate, sURL);
-                LOGEXTREME("signing input %s\n", get_string_stats(sInput));
+            // finally, SHA1 and sign with PK
+            assert((strlen(sVerb) + strlen(sDate) + strlen(sURL) + 4) <= BUFSIZE);
 
-                SHA1(((u8 *) sInput), strlen(sInput), sSHA1);
-                if ((ret = RSA_sign(NID_sha1, sSHA1, SHA_DIGEST_LENGTH, sSigBuffer, &siglen, pRSA)) != 1) {
-                    LOGERROR("RSA_sign() failed\n");
-                } else {
-                    LOGEXTREME("signing output %d\n", sSigBuffer[siglen - 1]);
-                    sSignature = base64_enc(sSigBuffer, siglen);
-                    LOGEXTREME("base64 signature %s\n", get_string_stats((char *)sSignature));
-                }
+            snprintf(sInput, BUFSIZE, "%s\n%s\n%s\n", sVerb, sDate, sURL);
+            LOGEXTREME("signing input %s\n", get_string_stats(sInput));
 
-                EUCA_FREE(sSigBuffer);
+            SHA1(((u8 *) sInput), strlen(sInput), sSHA1);
+            if (node_key_sign(NID_sha1, sSHA1, SHA_DIGEST_LENGTH, sSigBuffer, &siglen, pRSA) != 1) {
+                LOGERROR("RSA_sign() failed\n");
+            } else {
+                LOGEXTREME("signing output %d\n", sSigBuffer[siglen - 1]);
+                sSignature = base64_enc(sSigBuffer, siglen);
+                LOGEXTREME("base64 signature %s\n", get_string_stats((char *)sSignature));
             }
-
-            RSA_free(pRSA);
         }
-
-        fclose(pFile);
+        RSA_free(pRSA);
     }
 
     return (sSignature);
@@ -2134,7 +2871,7 @@ char *process_url(const char *content, int url_component)
     int substr_size = 0;
     char *substr = NULL;
     char *empty_str = NULL;
-    regmatch_t *match_array = NULL;
+    regmatch_t match_array[URL_MATCHES] = { {0} };
 
     init_url_regex();
 
@@ -2148,11 +2885,6 @@ char *process_url(const char *content, int url_component)
         return (NULL);
     }
 
-    if ((match_array = (regmatch_t *) EUCA_ZALLOC(uri_regex->re_nsub, sizeof(regmatch_t))) == NULL) {
-        LOGERROR("Failed to allocate memory.\n");
-        return (NULL);
-    }
-
     if (regexec(uri_regex, content, uri_regex->re_nsub, match_array, 0) == 0) {
         for (i = 0; i < uri_regex->re_nsub; i++) {
             substr_size = match_array[i].rm_eo - match_array[i].rm_so;
@@ -2160,15 +2892,12 @@ char *process_url(const char *content, int url_component)
                 if ((substr = (char *)EUCA_ZALLOC(substr_size, sizeof(char) + 1)) != NULL) {
                     strncpy(substr, &(content[match_array[i].rm_so]), substr_size);
                     substr[substr_size] = '\0';
-                    EUCA_FREE(match_array);
                     return (substr);
                 }
             }
         }
     }
 
-    EUCA_FREE(match_array);
-
     if ((empty_str = (char *)EUCA_ZALLOC(1, sizeof(char))) != NULL) {
         return (empty_str);
     }
@@ -2204,6 +2933,109 @@ void print_key_value_pair_array(const struct key_value_pair_array *kv_array)
     printf("Key-Value Pair array complete\n");
 }
 
+//!
+//! Checks the base64 and hex codecs picked for this CPU against the scalar ones and
+//! against EVP_EncodeBlock(), then times them on a 64 KB buffer
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int test_codecs(void)
+{
+#define CODEC_MAX_LEN      1024
+#define CODEC_BENCH_LEN    65536
+#define CODEC_BENCH_ROUNDS 1000
+
+    int i = 0;
+    int rounds = 0;
+    size_t len = 0;
+    size_t enc_len = 0;
+    size_t dec_len = 0;
+    long long start = 0;
+    u8 in[CODEC_MAX_LEN] = { 0 };
+    u8 dec[CODEC_MAX_LEN + 4] = { 0 };
+    char enc[EUCA_BASE64_ENCODED_LEN(CODEC_MAX_LEN) + 1] = "";
+    char ref[EUCA_BASE64_ENCODED_LEN(CODEC_MAX_LEN) + 1] = "";
+    char hex[CODEC_MAX_LEN * 2 + 1] = "";
+    char hex_ref[CODEC_MAX_LEN * 2 + 1] = "";
+    u8 *big = NULL;
+    char *big_enc = NULL;
+
+    pthread_once(&codecs_once, codecs_init);
+    for (len = 0; len < CODEC_MAX_LEN; len++) {
+        for (i = 0; i < CODEC_MAX_LEN; i++)
+            in[i] = random();
+
+        enc_len = euca_base64_encode(in, len, enc);
+        EVP_EncodeBlock((u8 *) ref, in, len);
+        if ((enc_len != strlen(ref)) || strcmp(enc, ref)) {
+            printf("base64 encoding of %lu bytes differs from EVP_EncodeBlock()\n", len);
+            return (EUCA_ERROR);
+        }
+
+        if ((euca_base64_decode(enc, enc_len, dec, &dec_len) != EUCA_OK) || (dec_len != len) || memcmp(dec, in, len)) {
+            printf("base64 decoding of %lu bytes failed\n", len);
+            return (EUCA_ERROR);
+        }
+
+        // without padding, and with a character outside of the alphabet
+        while (enc_len > 0 && enc[enc_len - 1] == '=')
+            enc_len--;
+        if ((euca_base64_decode(enc, enc_len, dec, &dec_len) != EUCA_OK) || (dec_len != len) || memcmp(dec, in, len)) {
+            printf("base64 decoding of %lu unpadded bytes failed\n", len);
+            return (EUCA_ERROR);
+        }
+        if (enc_len > 0) {
+            enc[random() % enc_len] = '*';
+            if (euca_base64_decode(enc, enc_len, dec, &dec_len) == EUCA_OK) {
+                printf("base64 decoding of invalid text succeeded\n");
+                return (EUCA_ERROR);
+            }
+        }
+
+        euca_hex_encode(in, len, hex);
+        hex_encode_scalar(in, len, hex_ref);
+        hex_ref[len * 2] = '\0';
+        if (strcmp(hex, hex_ref)) {
+            printf("hex encoding of %lu bytes differs from the scalar one\n", len);
+            return (EUCA_ERROR);
+        }
+    }
+
+    if ((big = EUCA_ALLOC(CODEC_BENCH_LEN, sizeof(u8))) == NULL || (big_enc = EUCA_ALLOC(EUCA_BASE64_ENCODED_LEN(CODEC_BENCH_LEN) + 1, sizeof(char))) == NULL) {
+        EUCA_FREE(big);
+        return (EUCA_ERROR);
+    }
+    for (i = 0; i < CODEC_BENCH_LEN; i++)
+        big[i] = random();
+
+    start = time_usec();
+    for (rounds = 0; rounds < CODEC_BENCH_ROUNDS; rounds++)
+        enc_len = euca_base64_encode(big, CODEC_BENCH_LEN, big_enc);
+    printf("base64 encoding: %.1f MB/s (scalar ", ((double)CODEC_BENCH_LEN * CODEC_BENCH_ROUNDS) / (time_usec() - start));
+    start = time_usec();
+    for (rounds = 0; rounds < CODEC_BENCH_ROUNDS; rounds++)
+        b64_encode_scalar(big, CODEC_BENCH_LEN, big_enc);
+    printf("%.1f MB/s)\n", ((double)CODEC_BENCH_LEN * CODEC_BENCH_ROUNDS) / (time_usec() - start));
+
+    start = time_usec();
+    for (rounds = 0; rounds < CODEC_BENCH_ROUNDS; rounds++)
+        euca_base64_decode(big_enc, enc_len, big, &dec_len);
+    printf("base64 decoding: %.1f MB/s (scalar ", ((double)CODEC_BENCH_LEN * CODEC_BENCH_ROUNDS) / (time_usec() - start));
+    start = time_usec();
+    for (rounds = 0; rounds < CODEC_BENCH_ROUNDS; rounds++)
+        b64_decode_scalar(big_enc, enc_len, big, &dec_len);
+    printf("%.1f MB/s)\n", ((double)CODEC_BENCH_LEN * CODEC_BENCH_ROUNDS) / (time_usec() - start));
+
+    EUCA_FREE(big);
+    EUCA_FREE(big_enc);
+    printf("base64 and hex codec tests passed\n");
+    return (EUCA_OK);
+
+#undef CODEC_MAX_LEN
+#undef CODEC_BENCH_LEN
+#undef CODEC_BENCH_ROUNDS
+}
+
 //!
 //! Main entry point of the application
 //!
@@ -2274,6 +3106,9 @@ int main(int argc, char **argv)
     } else {
         test_count = TEST_COUNT;
     }
+    if (test_codecs() != EUCA_OK)
+        return (EUCA_ERROR);
+
     printf("Initializing certs\n");
     euca_init_cert();
     printf("Running auth tests for %d iterations.\n", test_count);
@@ -2336,6 +3171,33 @@ int main(int argc, char **argv)
         }
 
         printf("Done testing query strings\n");
+        printf("\nComparing arena canonicalization with the construct_canonical_*() functions\n");
+
+        hdr_array = convert_header_list_to_array(list, ':');
+        for (i = 0; i < URL_COUNT; i++) {
+            char *uri = construct_canonical_uri(test_urls[i]);
+            char *query = construct_canonical_query(test_urls[i]);
+            char *hdrs = construct_canonical_headers(hdr_array);
+            char *signed_hdrs = construct_signed_headers(hdr_array);
+            char *fast_signed = NULL;
+            char expected[4096] = "";
+            char arena_buf[SIGN_ARENA_SIZE] = "";
+            sign_arena arena = { arena_buf, sizeof(arena_buf), 0 };
+            char *fast = canonicalize_request(&arena, "GET", test_urls[i], list, &fast_signed);
+
+            snprintf(expected, sizeof(expected), "GET\n%s\n%s\n%s\n%s", uri, (query ? query : ""), hdrs, signed_hdrs);
+            if ((fast == NULL) || strcmp(fast, expected) || strcmp(fast_signed, signed_hdrs)) {
+                printf("Mismatch for %s:\n%s\n--- vs ---\n%s\n", test_urls[i], expected, (fast ? fast : "(null)"));
+                return (EUCA_ERROR);
+            }
+            EUCA_FREE(uri);
+            EUCA_FREE(query);
+            EUCA_FREE(hdrs);
+            EUCA_FREE(signed_hdrs);
+        }
+        free_key_value_pair_array(hdr_array);
+        hdr_array = NULL;
+        printf("Done comparing canonicalization\n");
 
         for (i = 0; i < URL_COUNT; i++) {
             printf("\nTesting signing for url: %s\n", test_urls[i]);
@@ -78,6 +78,7 @@
 \*----------------------------------------------------------------------------*/
 
 #include <curl/curl.h>
+#include <openssl/evp.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -107,6 +108,9 @@
 
 //! @}
 
+#define EUCA_BASE64_ENCODED_LEN(_n)             ((((_n) + 2) / 3) * 4) //!< length of the base64 encoding of _n bytes, without the NUL
+#define EUCA_BASE64_DECODED_MAX(_n)             ((((_n) + 3) / 4) * 3) //!< most bytes that _n base64 characters can decode to
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -151,6 +155,9 @@ struct key_value_pair_array {
 
 int euca_init_cert(void);
 char *euca_get_cert(u8 options);
+size_t euca_base64_encode(const u8 * in, size_t len, char *out);
+int euca_base64_decode(const char *in, size_t len, u8 * out, size_t * pOutLen);
+void euca_hex_encode(const u8 * in, size_t len, char *out);
 char *base64_enc(u8 * sIn, int size);
 char *base64_dec(u8 * sIn, int size);
 char *base64_dec2(u8 * sIn, int size, int *decoded_length);
@@ -171,6 +178,8 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer);
 int encrypt_string_with_cloud(char *in_str, char **out_buffer);
 int encrypt_string_with_node(char *in_str, char **out_buffer);
 int decrypt_string_with_node(char *in_str, char **out_buffer);
+EVP_PKEY_CTX *euca_get_key_ctx(const char *key_file);
+EVP_PKEY_CTX *euca_get_cert_ctx(const char *cert_file);
 int decrypt_string_with_node_and_symmetric_key(char *in_buffer, char *key_buffer, char **out_buffer, int *out_len);
 int encrypt_string_symmetric(char *in_buffer, char *key_buffer, char *iv_buffer, char **out_buffer, int *out_len);
 int decrypt_string_symmetric(char *in_buffer, char *key_buffer, char *iv_buffer, char **out_buffer, int *out_len);
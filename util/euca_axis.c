@@ -105,6 +105,11 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
 #include "eucalyptus.h"
 #include "oxs_axiom.h"
 #include "oxs_x509_cert.h"
@@ -127,7 +132,9 @@
 
 #include "misc.h"                      // check_file, logprintf
 #include "fault.h"                     // log_eucafault
+#include "euca_string.h"               // euca_strncpy
 #include "euca_axis.h"
+#include "euca_arena.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -135,6 +142,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define PEER_CERT_CACHE_SIZE                     16 //!< signing certificates remembered once validated against the receiver certificate
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -153,6 +162,16 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Receiver certificate of the service and the signing certificates already found to match it
+typedef struct cert_cache_t {
+    char sFileName[EUCA_MAX_PATH];     //!< file the receiver certificate was loaded from
+    time_t mtime;                      //!< modification time of that file when it was loaded
+    off_t size;                        //!< size of that file when it was loaded
+    char *sRecvX509Buf;                //!< data of the receiver certificate, NULL if not loaded
+    char *asPeerCerts[PEER_CERT_CACHE_SIZE];    //!< content of BinarySecurityTokens whose certificate matched
+    int nextPeer;                      //!< entry of asPeerCerts[] to replace next
+} cert_cache;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -173,6 +192,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static cert_cache certCache = { "" };  //!< certificates of the authenticated peers, guarded by certCacheLock
+static pthread_mutex_t certCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -180,6 +202,12 @@
 \*----------------------------------------------------------------------------*/
 
 static void throw_fault(void);
+static int cert_cache_refresh(const axutil_env_t * pEnv, const char *sFileName);
+static boolean cert_cache_has_peer(const char *sData);
+static void cert_cache_add_peer(const char *sData);
+static void *AXIS2_CALL arena_malloc(axutil_allocator_t * pAllocator, size_t size);
+static void *AXIS2_CALL arena_realloc(axutil_allocator_t * pAllocator, void *pPtr, size_t size);
+static void AXIS2_CALL arena_free(axutil_allocator_t * pAllocator, void *pPtr);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -212,6 +240,87 @@ static void throw_fault(void)
     log_eucafault("1009", "sender", euca_client_component_name, "receiver", euca_this_component_name, "keys_dir", "$EUCALYPTUS/var/lib/eucalyptus/keys/", NULL);
 }
 
+//!
+//! Makes sure the cached receiver certificate is the one in the given file, reloading it
+//! and forgetting the validated peers if the file changed. The caller holds certCacheLock.
+//!
+//! @param[in] pEnv pointer to the AXIS2 environment structure
+//! @param[in] sFileName path of the receiver certificate
+//!
+//! @return EUCA_OK on success, EUCA_NOT_FOUND_ERROR if there is no such file or EUCA_ERROR
+//!         if the certificate cannot be loaded
+//!
+static int cert_cache_refresh(const axutil_env_t * pEnv, const char *sFileName)
+{
+    int i = 0;
+    char *sData = NULL;
+    struct stat st = { 0 };
+    oxs_x509_cert_t *pRecvCert = NULL;
+
+    if (check_file(sFileName) || (stat(sFileName, &st) != 0))
+        return (EUCA_NOT_FOUND_ERROR);
+
+    if ((certCache.sRecvX509Buf != NULL) && !strcmp(certCache.sFileName, sFileName) && (certCache.mtime == st.st_mtime) && (certCache.size == st.st_size))
+        return (EUCA_OK);
+
+    EUCA_FREE(certCache.sRecvX509Buf);
+    for (i = 0; i < PEER_CERT_CACHE_SIZE; i++) {
+        EUCA_FREE(certCache.asPeerCerts[i]);
+    }
+    certCache.nextPeer = 0;
+
+    if ((pRecvCert = oxs_key_mgr_load_x509_cert_from_pem_file(pEnv, sFileName)) == NULL)
+        return (EUCA_ERROR);
+
+    if ((sData = oxs_x509_cert_get_data(pRecvCert, pEnv)) != NULL)
+        certCache.sRecvX509Buf = strdup(sData);
+    oxs_x509_cert_free(pRecvCert, pEnv);
+    if (certCache.sRecvX509Buf == NULL)
+        return (EUCA_ERROR);
+
+    euca_strncpy(certCache.sFileName, sFileName, sizeof(certCache.sFileName));
+    certCache.mtime = st.st_mtime;
+    certCache.size = st.st_size;
+    return (EUCA_OK);
+}
+
+//!
+//! Tells whether a BinarySecurityToken carries a certificate already found to match the
+//! receiver certificate. The caller holds certCacheLock.
+//!
+//! @param[in] sData content of the wsse:BinarySecurityToken
+//!
+//! @return TRUE if the certificate is known to be valid, FALSE otherwise
+//!
+static boolean cert_cache_has_peer(const char *sData)
+{
+    int i = 0;
+
+    for (i = 0; (sData != NULL) && (i < PEER_CERT_CACHE_SIZE); i++) {
+        if ((certCache.asPeerCerts[i] != NULL) && !strcmp(certCache.asPeerCerts[i], sData))
+            return (TRUE);
+    }
+    return (FALSE);
+}
+
+//!
+//! Remembers a BinarySecurityToken whose certificate matched the receiver certificate, in
+//! place of the oldest one. The caller holds certCacheLock.
+//!
+//! @param[in] sData content of the wsse:BinarySecurityToken
+//!
+static void cert_cache_add_peer(const char *sData)
+{
+    char *sCopy = NULL;
+
+    if ((sData == NULL) || ((sCopy = strdup(sData)) == NULL))
+        return;
+
+    EUCA_FREE(certCache.asPeerCerts[certCache.nextPeer]);
+    certCache.asPeerCerts[certCache.nextPeer] = sCopy;
+    certCache.nextPeer = ((certCache.nextPeer + 1) % PEER_CERT_CACHE_SIZE);
+}
+
 //!
 //! Eucalyptus authentication
 //!
@@ -242,10 +351,10 @@ axis2_status_t __euca_authenticate(const axutil_env_t * pEnv, axis2_msg_ctx_t *
     axiom_node_t *pBstNode = NULL;
     axis2_char_t *sData = NULL;
     oxs_x509_cert_t *pCert = NULL;
-    oxs_x509_cert_t *pRecvCert = NULL;
     axis2_char_t *sFileName = NULL;
-    axis2_char_t *sRecvX509Buf = NULL;
     axis2_char_t *sMsgX509Buf = NULL;
+    int rc = EUCA_OK;
+    boolean trusted = FALSE;
 
     // First get the message context before doing anything dumb w/ a NULL pointer
     pMsgCtx = axis2_op_ctx_get_msg_ctx(pOpCtx, pEnv, AXIS2_WSDL_MESSAGE_LABEL_IN);
@@ -300,46 +409,62 @@ axis2_status_t __euca_authenticate(const axutil_env_t * pEnv, axis2_msg_ctx_t *
     // pull out the data from the BST
     sData = oxs_axiom_get_node_content(pEnv, pBstNode);
 
-    // create an oxs_X509_cert
-    if ((pCert = oxs_key_mgr_load_x509_cert_from_string(pEnv, sData)) != NULL) {
-        // FINALLY -- we have the certificate used to sign the message.  authenticate it HERE
-        if ((sMsgX509Buf = oxs_x509_cert_get_data(pCert, pEnv)) == NULL)
-            NO_U_FAIL("OMG WHAT NOW?!");
+    if ((sFileName = rampart_context_get_receiver_certificate_file(pRampartCtx, pEnv)) == NULL)
+        NO_U_FAIL("Policy for the service is incorrect -- ReceiverCertificate is not set!!");
+
+    // the receiver certificate is only reloaded when its file changes and a signing certificate
+    // that already matched it is not parsed and compared again, which the polling peers hit
+    pthread_mutex_lock(&certCacheLock);
+    {
+        if ((rc = cert_cache_refresh(pEnv, sFileName)) == EUCA_OK)
+            trusted = cert_cache_has_peer(sData);
+    }
+    pthread_mutex_unlock(&certCacheLock);
 
-        if ((sFileName = rampart_context_get_receiver_certificate_file(pRampartCtx, pEnv)) == NULL)
-            NO_U_FAIL("Policy for the service is incorrect -- ReceiverCertificate is not set!!");
+    if (rc == EUCA_NOT_FOUND_ERROR)
+        NO_U_FAIL("No cert file ($EUCALYPTUS/var/lib/eucalyptus/keys/cloud-cert.pem) found, failing");
 
-        if (check_file(sFileName))
-            NO_U_FAIL("No cert file ($EUCALYPTUS/var/lib/eucalyptus/keys/cloud-cert.pem) found, failing");
+    if (rc != EUCA_OK) {
+        throw_fault();
+        NO_U_FAIL("could not populate receiver certificate");
+    }
 
-        if ((pRecvCert = oxs_key_mgr_load_x509_cert_from_pem_file(pEnv, sFileName)) != NULL) {
-            sRecvX509Buf = oxs_x509_cert_get_data(pRecvCert, pEnv);
-        } else {
+    if (!trusted) {
+        // create an oxs_X509_cert
+        if ((pCert = oxs_key_mgr_load_x509_cert_from_string(pEnv, sData)) == NULL) {
             throw_fault();
-            NO_U_FAIL("could not populate receiver certificate");
+            oxs_error(pEnv, OXS_ERROR_LOCATION, OXS_ERROR_DEFAULT, "Cannot load certificate from string =%s", sData);
+            NO_U_FAIL("Failed to build certificate from BinarySecurityToken");
+        }
+        // FINALLY -- we have the certificate used to sign the message.  authenticate it HERE
+        if ((sMsgX509Buf = oxs_x509_cert_get_data(pCert, pEnv)) == NULL)
+            NO_U_FAIL("OMG WHAT NOW?!");
+
+        pthread_mutex_lock(&certCacheLock);
+        {
+            if ((certCache.sRecvX509Buf != NULL) && !axutil_strcmp(certCache.sRecvX509Buf, sMsgX509Buf)) {
+                cert_cache_add_peer(sData);
+                trusted = TRUE;
+            } else {
+                AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, " --------- Received x509 certificate value ---------");
+                AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, sMsgX509Buf);
+                AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, " --------- Local x509 certificate value! ---------");
+                AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, ((certCache.sRecvX509Buf != NULL) ? certCache.sRecvX509Buf : ""));
+                AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, " ---------------------------------------------------");
+            }
         }
+        pthread_mutex_unlock(&certCacheLock);
+        oxs_x509_cert_free(pCert, pEnv);
 
-        if (axutil_strcmp(sRecvX509Buf, sMsgX509Buf) != 0) {
-            AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, " --------- Received x509 certificate value ---------");
-            AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, sMsgX509Buf);
-            AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, " --------- Local x509 certificate value! ---------");
-            AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, sRecvX509Buf);
-            AXIS2_LOG_CRITICAL(pEnv->log, AXIS2_LOG_SI, " ---------------------------------------------------");
+        if (!trusted) {
             throw_fault();
             NO_U_FAIL("The certificate specified is invalid!");
         }
-
-        if (verify_references(pSigNode, pEnv, pOutMsgCtx, pSoapEnvelope, pRampartCtx) == AXIS2_FAILURE) {
-            return (AXIS2_FAILURE);
-        }
-    } else {
-        throw_fault();
-        oxs_error(pEnv, OXS_ERROR_LOCATION, OXS_ERROR_DEFAULT, "Cannot load certificate from string =%s", sData);
-        NO_U_FAIL("Failed to build certificate from BinarySecurityToken");
     }
 
-    oxs_x509_cert_free(pCert, pEnv);
-    oxs_x509_cert_free(pRecvCert, pEnv);
+    if (verify_references(pSigNode, pEnv, pOutMsgCtx, pSoapEnvelope, pRampartCtx) == AXIS2_FAILURE) {
+        return (AXIS2_FAILURE);
+    }
     return (AXIS2_SUCCESS);
 }
 
@@ -391,17 +516,20 @@ axis2_status_t verify_references(axiom_node_t * pSigNode, const axutil_env_t * p
     pQnameIter = axiom_element_get_children_with_qname(pParentElem, pEnv, pQname, pSiNode);
     while (axiom_children_qname_iterator_has_next(pQnameIter, pEnv)) {
         pRefNode = axiom_children_qname_iterator_next(pQnameIter, pEnv);
-        sText = axiom_node_to_string(pRefNode, pEnv);
 
         // get reference to a signed element
         sRef = oxs_token_get_reference(pEnv, pRefNode);
         if ((sRef == NULL) || (strlen(sRef) == 0) || (sRef[0] != '#')) {
+            sText = axiom_node_to_string(pRefNode, pEnv);
             oxs_error(pEnv, OXS_ERROR_LOCATION, OXS_ERROR_ELEMENT_FAILED, "Unsupported reference ID in %s", sText);
             status = AXIS2_FAILURE;
             break;
         }
-
-        AXIS2_LOG_DEBUG(pEnv->log, AXIS2_LOG_SI, "[euca-rampart] %s, ref = %s", sText, sRef);
+        // serializing the Reference on every request is only worth it when its content gets logged
+        if (pEnv->log && (pEnv->log->level >= AXIS2_LOG_LEVEL_DEBUG)) {
+            sText = axiom_node_to_string(pRefNode, pEnv);
+            AXIS2_LOG_DEBUG(pEnv->log, AXIS2_LOG_SI, "[euca-rampart] %s, ref = %s", sText, sRef);
+        }
 
         // get rid of '#'
         sRefId = axutil_string_substring_starting_at(axutil_strdup(pEnv, sRef), 1);
@@ -580,3 +708,86 @@ int InitWSSEC(axutil_env_t * pEnv, axis2_stub_t * pStub, char *sPolicyFile)
     status = axis2_svc_client_set_policy(pSvcClient, pEnv, pPolicy);
     return (EUCA_OK);
 }
+
+//!
+//! Axis2 allocator callback taking memory from the arena held in the local pool
+//!
+//! @param[in] pAllocator pointer to the AXIS2 allocator
+//! @param[in] size
+//!
+//! @return the memory or NULL if out of memory
+//!
+static void *AXIS2_CALL arena_malloc(axutil_allocator_t * pAllocator, size_t size)
+{
+    return (euca_arena_alloc((euca_arena *) pAllocator->local_pool, size));
+}
+
+//!
+//! Axis2 allocator callback resizing memory of the arena held in the local pool
+//!
+//! @param[in] pAllocator pointer to the AXIS2 allocator
+//! @param[in] pPtr
+//! @param[in] size
+//!
+//! @return the memory or NULL if out of memory
+//!
+static void *AXIS2_CALL arena_realloc(axutil_allocator_t * pAllocator, void *pPtr, size_t size)
+{
+    return (euca_arena_realloc((euca_arena *) pAllocator->local_pool, pPtr, size));
+}
+
+//!
+//! Axis2 allocator callback, memory goes back only when the arena is destroyed
+//!
+//! @param[in] pAllocator pointer to the AXIS2 allocator
+//! @param[in] pPtr
+//!
+static void AXIS2_CALL arena_free(axutil_allocator_t * pAllocator, void *pPtr)
+{
+}
+
+//!
+//! Creates an AXIS2 environment, as axutil_env_create_all() does, but with everything it ever
+//! allocates, including the ADB objects of each call, taken from an arena. Nothing is returned
+//! to malloc() before euca_arena_destroy(), which the caller does after axutil_env_free(). An
+//! arena is not thread safe, so the environment must only be used by one thread at a time.
+//!
+//! @param[in] arena the arena backing the environment
+//! @param[in] sLogFile path of the AXIS2 log file, or NULL for the default log
+//! @param[in] level AXIS2 log level
+//!
+//! @return a pointer to the environment or NULL on failure
+//!
+axutil_env_t *euca_arena_env_create(euca_arena * arena, const char *sLogFile, axutil_log_levels_t level)
+{
+    axutil_env_t *pEnv = NULL;
+    axutil_log_t *pLog = NULL;
+    axutil_error_t *pError = NULL;
+    axutil_allocator_t *pAllocator = NULL;
+    axutil_thread_pool_t *pThreadPool = NULL;
+
+    if ((arena == NULL) || ((pAllocator = euca_arena_alloc(arena, sizeof(axutil_allocator_t))) == NULL))
+        return (NULL);
+
+    memset(pAllocator, 0, sizeof(axutil_allocator_t));
+    pAllocator->malloc_fn = arena_malloc;
+    pAllocator->realloc = arena_realloc;
+    pAllocator->free_fn = arena_free;
+    pAllocator->local_pool = arena;
+    pAllocator->global_pool = arena;
+    pAllocator->current_pool = arena;
+
+    if ((pError = axutil_error_create(pAllocator)) == NULL)
+        return (NULL);
+
+    if ((sLogFile == NULL) || ((pLog = axutil_log_create(pAllocator, NULL, sLogFile)) == NULL))
+        pLog = axutil_log_create_default(pAllocator);
+    pThreadPool = axutil_thread_pool_init(pAllocator);
+
+    if ((pEnv = axutil_env_create_with_error_log_thread_pool(pAllocator, pError, pLog, pThreadPool)) == NULL)
+        return (NULL);
+
+    if (pEnv->log)
+        pEnv->log->level = level;
+    return (pEnv);
+}
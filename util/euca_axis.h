@@ -92,6 +92,8 @@
 #include <axis2_client.h>
 #include <axis2_stub.h>
 
+#include "euca_arena.h"
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -134,6 +136,7 @@ int verify_node(axiom_node_t * pSigNode, const axutil_env_t * pEnv, axis2_msg_ct
 int verify_addr_hdr_elem_loc(axiom_node_t * pSigNode, const axutil_env_t * pEnv, axis2_char_t * sRef);
 
 int InitWSSEC(axutil_env_t * pEnv, axis2_stub_t * pStub, char *sPolicyFile);
+axutil_env_t *euca_arena_env_create(euca_arena * arena, const char *sLogFile, axutil_log_levels_t level);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
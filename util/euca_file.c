@@ -160,6 +160,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static char *fd2str(int fd, const char *path, const ssize_t limit);
+static int file_view_fd(int fd, const char *path, off_t offset, size_t len, file_view * view);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -515,16 +518,22 @@ char *fp2str(FILE * fp)
 {
 #define INCREMENT              512
 
-    int buf_max = INCREMENT;
-    int buf_current = 0;
-    void *new_buf = NULL;
-    char *last_read = NULL;
+    int c = 0;
+    off_t pos = 0;
+    size_t buf_max = INCREMENT;
+    size_t buf_current = 0;
+    char *new_buf = NULL;
     char *buf = NULL;
+    struct stat mystat = { 0 };
 
     if (fp == NULL)
         return (NULL);
 
-    do {
+    // the rest of a regular file is read in one go, anything else grows the buffer as it is read
+    if ((fstat(fileno(fp), &mystat) == 0) && S_ISREG(mystat.st_mode) && ((pos = ftello(fp)) >= 0) && (mystat.st_size > pos))
+        buf_max = (mystat.st_size - pos) + 1;
+
+    for (;;) {
         // create/enlarge the buffer
         if ((new_buf = EUCA_REALLOC(buf, buf_max, sizeof(char))) == NULL) {
             // free partial buffer
@@ -532,28 +541,27 @@ char *fp2str(FILE * fp)
             return (NULL);
         }
 
-        memset((new_buf + buf_current), 0, (INCREMENT * sizeof(char)));
-
         buf = new_buf;
-        LOGEXTREME("enlarged buf to %d\n", buf_max);
-
-        do {                           // read in until EOF or buffer is full
-            last_read = fgets(buf + buf_current, buf_max - buf_current, fp);
-            if (last_read != NULL) {
-                buf_current = strlen(buf);
-            } else if (!feof(fp)) {
-                LOGERROR("failed while reading from file handle\n");
-                EUCA_FREE(buf);
-                return (NULL);
-            }
+        LOGEXTREME("enlarged buf to %lu\n", buf_max);
 
-            LOGEXTREME("read %d characters so far (max=%d, last=%s)\n", buf_current, buf_max, last_read ? "no" : "yes");
-        } while (last_read && (buf_max > (buf_current + 1)));   // +1 is needed for fgets() to put \0
+        buf_current += fread((buf + buf_current), sizeof(char), (buf_max - buf_current - 1), fp);
+        if (ferror(fp)) {
+            LOGERROR("failed while reading from file handle\n");
+            EUCA_FREE(buf);
+            return (NULL);
+        }
 
-        // in case it is full
-        buf_max += INCREMENT;
-    } while (last_read);
+        LOGEXTREME("read %lu characters so far (max=%lu)\n", buf_current, buf_max);
 
+        // stop on a short read, or when a full buffer turns out to hold all there is
+        if ((buf_current < (buf_max - 1)) || ((c = fgetc(fp)) == EOF))
+            break;
+
+        buf[buf_current++] = c;
+        buf_max *= 2;
+    }
+
+    buf[buf_current] = '\0';
     return (buf);
 
 #undef INCREMENT
@@ -730,14 +738,13 @@ int write2file(const char *path, char *str)
 
     return (EUCA_IO_ERROR);
 }
-
-//!
 //!
+//! read file 'path' into a new string, unless it is larger than 'limit'
 //!
 //! @param[in] path
-//! @param[in] limit
+//! @param[in] limit the largest file accepted, or -1 for any size
 //!
-//! @return the result of teh file2str() call
+//! @return the string content of the given file or NULL on failure
 //!
 //! @see file2str()
 //!
@@ -745,19 +752,17 @@ int write2file(const char *path, char *str)
 //!
 char *file2strn(const char *path, const ssize_t limit)
 {
-    struct stat mystat = { 0 };
-
-    if (stat(path, &mystat) < 0) {
-        LOGERROR("could not stat file %s\n", path);
-        return (NULL);
-    }
+    int fd = 0;
+    char *content = NULL;
 
-    if (mystat.st_size > limit) {
-        LOGERROR("file %s exceeds the limit (%lu) in file2strn()\n", path, limit);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        LOGERROR("failed to open file %s\n", path);
         return (NULL);
     }
 
-    return (file2str(path));
+    content = fd2str(fd, path, limit);
+    close(fd);
+    return (content);
 }
 
 //!
@@ -771,52 +776,59 @@ char *file2strn(const char *path, const ssize_t limit)
 //!
 char *file2str(const char *path)
 {
-    int fp = 0;
-    int bytes = 0;
-    int bytes_total = 0;
-    int to_read = 0;
-    char *p = NULL;
+    return (file2strn(path, -1));
+}
+
+//!
+//! Reads the content of an open file into a new string sized once, from fstat()
+//!
+//! @param[in] fd the file descriptor to read from
+//! @param[in] path the path of the file, for the log messages
+//! @param[in] limit the largest file accepted, or -1 for any size
+//!
+//! @return the string content of the file or NULL on failure
+//!
+//! @note the caller must free the memory when done.
+//!
+static char *fd2str(int fd, const char *path, const ssize_t limit)
+{
+    ssize_t bytes = 0;
+    size_t size = 0;
+    size_t total = 0;
     char *content = NULL;
-    off_t file_size = 0;
     struct stat mystat = { 0 };
 
-    if (stat(path, &mystat) < 0) {
+    if (fstat(fd, &mystat) < 0) {
         LOGERROR("could not stat file %s\n", path);
-        return (content);
+        return (NULL);
     }
 
-    file_size = mystat.st_size;
-
-    if ((content = EUCA_ALLOC((file_size + 1), sizeof(char))) == NULL) {
-        LOGERROR("out of memory reading file %s\n", path);
-        return (content);
+    if ((limit >= 0) && (mystat.st_size > limit)) {
+        LOGERROR("file %s exceeds the limit (%ld) in file2strn()\n", path, limit);
+        return (NULL);
     }
 
-    if ((fp = open(path, O_RDONLY)) < 0) {
-        LOGERROR("failed to open file %s\n", path);
-        EUCA_FREE(content);
-        return (content);
+    size = mystat.st_size;
+    if ((content = EUCA_ALLOC((size + 1), sizeof(char))) == NULL) {
+        LOGERROR("out of memory reading file %s\n", path);
+        return (NULL);
     }
 
-    p = content;
-    to_read = (((SSIZE_MAX) < file_size) ? (SSIZE_MAX) : file_size);
-    while ((bytes = read(fp, p, to_read)) > 0) {
-        bytes_total += bytes;
-        p += bytes;
-        if (to_read > (file_size - bytes_total)) {
-            to_read = file_size - bytes_total;
+    while (total < size) {
+        if ((bytes = read(fd, (content + total), MIN((size - total), SSIZE_MAX))) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to read file %s\n", path);
+            EUCA_FREE(content);
+            return (NULL);
         }
-    }
 
-    close(fp);
-
-    if (bytes < 0) {
-        LOGERROR("failed to read file %s\n", path);
-        EUCA_FREE(content);
-        return (content);
+        if (bytes == 0)
+            break;
+        total += bytes;
     }
 
-    *p = '\0';
+    content[total] = '\0';
     return (content);
 }
 
@@ -877,6 +889,182 @@ char *file2str_seek(char *file, size_t size, int mode)
     return (ret);
 }
 
+//!
+//! Opens a read-only view of the content of a file. Small files are read into memory
+//! with a single read, files of FILE_VIEW_MAP_MIN bytes or more are mapped instead so
+//! large network documents and console logs are not copied around. Either way the
+//! content is view->len bytes long and followed by a '\0'.
+//!
+//! @param[in]  path the path of the file to view
+//! @param[in]  limit the largest file accepted, or -1 for any size
+//! @param[out] view the view to fill, to be released with file_view_close()
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR, EUCA_ACCESS_ERROR, EUCA_IO_ERROR
+//!         or EUCA_MEMORY_ERROR on failure
+//!
+//! @note a mapped file must not be truncated in place while it is viewed; files that
+//!       are replaced with rename(), like the ones written through atomic_file, are safe
+//!
+int file_view_open(const char *path, const ssize_t limit, file_view * view)
+{
+    int fd = 0;
+    int rc = EUCA_OK;
+    struct stat mystat = { 0 };
+
+    if (!path || !view)
+        return (EUCA_INVALID_ERROR);
+
+    bzero(view, sizeof(file_view));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        LOGERROR("failed to open file %s\n", path);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    if (fstat(fd, &mystat) < 0) {
+        LOGERROR("could not stat file %s\n", path);
+        close(fd);
+        return (EUCA_IO_ERROR);
+    }
+
+    if ((limit >= 0) && (mystat.st_size > limit)) {
+        LOGERROR("file %s exceeds the limit (%ld) in file_view_open()\n", path, limit);
+        close(fd);
+        return (EUCA_INVALID_ERROR);
+    }
+
+    rc = file_view_fd(fd, path, 0, mystat.st_size, view);
+    close(fd);
+    return (rc);
+}
+
+//!
+//! Opens a read-only view of the last 'size' bytes of a file, or of all of it when
+//! it is smaller than that. See file_view_open().
+//!
+//! @param[in]  path the path of the file to view
+//! @param[in]  size the most bytes to view
+//! @param[out] view the view to fill, to be released with file_view_close()
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR, EUCA_ACCESS_ERROR, EUCA_IO_ERROR
+//!         or EUCA_MEMORY_ERROR on failure
+//!
+int file_view_tail(const char *path, size_t size, file_view * view)
+{
+    int fd = 0;
+    int rc = EUCA_OK;
+    off_t offset = 0;
+    struct stat mystat = { 0 };
+
+    if (!path || !view)
+        return (EUCA_INVALID_ERROR);
+
+    bzero(view, sizeof(file_view));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        LOGERROR("failed to open file %s\n", path);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    if (fstat(fd, &mystat) < 0) {
+        LOGERROR("could not stat file %s\n", path);
+        close(fd);
+        return (EUCA_IO_ERROR);
+    }
+
+    if (mystat.st_size > size)
+        offset = mystat.st_size - size;
+
+    rc = file_view_fd(fd, path, offset, (mystat.st_size - offset), view);
+    close(fd);
+    return (rc);
+}
+
+//!
+//! Releases a view opened with file_view_open() or file_view_tail()
+//!
+//! @param[in] view the view to release
+//!
+void file_view_close(file_view * view)
+{
+    if (!view)
+        return;
+
+    if (view->map)
+        munmap(view->map, view->map_len);
+    else
+        EUCA_FREE(view->data);
+    bzero(view, sizeof(file_view));
+}
+
+//!
+//! Fills a view with 'len' bytes of an open file starting at 'offset'
+//!
+//! @param[in]  fd the file descriptor to view
+//! @param[in]  path the path of the file, for the log messages
+//! @param[in]  offset where in the file the view starts
+//! @param[in]  len the number of bytes to view
+//! @param[out] view the view to fill
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR or EUCA_MEMORY_ERROR on failure
+//!
+static int file_view_fd(int fd, const char *path, off_t offset, size_t len, file_view * view)
+{
+    off_t start = 0;
+    size_t skip = 0;
+    size_t total = 0;
+    ssize_t bytes = 0;
+    char *map = NULL;
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (len < FILE_VIEW_MAP_MIN) {
+        if ((view->data = EUCA_ALLOC((len + 1), sizeof(char))) == NULL) {
+            LOGERROR("out of memory reading file %s\n", path);
+            return (EUCA_MEMORY_ERROR);
+        }
+
+        while (total < len) {
+            if ((bytes = pread(fd, (view->data + total), (len - total), (offset + total))) < 0) {
+                if (errno == EINTR)
+                    continue;
+                LOGERROR("failed to read file %s\n", path);
+                EUCA_FREE(view->data);
+                return (EUCA_IO_ERROR);
+            }
+
+            if (bytes == 0)
+                break;
+            total += bytes;
+        }
+
+        view->data[total] = '\0';
+        view->len = total;
+        return (EUCA_OK);
+    }
+    // a mapping starts on a page boundary. Reserve the pages with a byte to spare, so the
+    // content is followed by a '\0' even when it ends on a page boundary, then map the file
+    // over all but the spare.
+    start = offset - (offset % page);
+    skip = offset - start;
+    view->map_len = skip + len + 1;
+    if ((map = mmap(NULL, view->map_len, PROT_READ, (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0)) == MAP_FAILED) {
+        LOGERROR("out of address space mapping file %s\n", path);
+        view->map_len = 0;
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    if (mmap(map, (skip + len), PROT_READ, (MAP_PRIVATE | MAP_FIXED), fd, start) == MAP_FAILED) {
+        LOGERROR("failed to map file %s\n", path);
+        munmap(map, view->map_len);
+        view->map_len = 0;
+        return (EUCA_IO_ERROR);
+    }
+
+    madvise(map, (skip + len), MADV_SEQUENTIAL);
+    view->map = map;
+    view->data = map + skip;
+    view->len = len;
+    return (EUCA_OK);
+}
+
 //!
 //! Write a NULL-terminated string to a file according to a file
 //! specification. If 'mktemp' is TRUE, 'path' is expected to be
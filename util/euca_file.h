@@ -84,12 +84,22 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define FILE_VIEW_MAP_MIN                        (64 * 1024)    //!< views of at least this many bytes are mapped rather than read
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Read-only view of the content of a file, see file_view_open()
+typedef struct file_view_t {
+    char *data;                        //!< the content, always followed by a '\0'
+    size_t len;                        //!< number of bytes of content, not counting the '\0'
+    void *map;                         //!< start of the mapping, NULL if the content was read into memory
+    size_t map_len;                    //!< length of the mapping
+} file_view;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -133,6 +143,9 @@ int write2file(const char *path, char *str);
 char *file2strn(const char *path, const ssize_t limit);
 char *file2str(const char *path);
 char *file2str_seek(char *file, size_t size, int mode);
+int file_view_open(const char *path, const ssize_t limit, file_view * view);
+int file_view_tail(const char *path, size_t size, file_view * view);
+void file_view_close(file_view * view);
 int str2file(const char *str, char *path, int flags, mode_t mode, boolean mktemp);
 int copy_file(const char *src, const char *dst);
 long long file_size(const char *file_path);
@@ -0,0 +1,849 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/euca_privd.c
+//! Implements euca_privd, the long-lived privileged helper of a component. Started once
+//! through euca_rootwrap, it runs the privileged commands of the component without the
+//! double exec (euca_rootwrap, then the tool) that each of them costs otherwise, and runs
+//! the most common ones (loop devices, device mapper, mounts) natively. Only an allowlist
+//! of commands is accepted; the component runs anything else through euca_rootwrap as
+//! before. See euca_privd.h for the protocol.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <linux/loop.h>
+
+#include "eucalyptus.h"
+#include "euca_string.h"
+#include "euca_privd.h"
+
+#ifdef HAVE_LIBDEVMAPPER
+#include <libdevmapper.h>
+#endif /* HAVE_LIBDEVMAPPER */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define PRIVD_MAX_DIRS                            8     //!< number of directories commands may be run from
+#define PRIVD_WAIT_USEC                       10000     //!< how often a command is checked for exit when pidfds are unavailable
+#define NATIVE_UNHANDLED                         -1     //!< returned by a native implementation that does not handle the form of a command
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Implementation of a command inside the helper. Returns the exit code of the command or NATIVE_UNHANDLED.
+typedef int (*native_fn) (int argc, char **argv, int out_fd, int err_fd);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A command the helper accepts, and its native implementation if it has one
+typedef struct privd_command_t {
+    const char *name;                  //!< the program, without its path
+    native_fn native;                  //!< its implementation inside the helper, or NULL to always exec it
+} privd_command;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static char allowed_dirs[PRIVD_MAX_DIRS][EUCA_MAX_PATH] = { "/sbin/", "/usr/sbin/", "/bin/", "/usr/bin/", "/usr/local/sbin/", "/usr/local/bin/" };   //!< where allowed commands may be run from
+static int allowed_dirs_len = 6;       //!< number of entries in allowed_dirs
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static void init_allowed_dirs(void);
+static const privd_command *find_command(const char *path);
+static int recv_request(int sock, euca_privd_request * req, int *fds, int *nfds);
+static int send_reply(int sock, int type, int result, int status);
+static int wait_command(pid_t pid, int timeout_sec, int *pStatus);
+static int run_command(char **args, const char *stdin_path, int out_fd, int err_fd, int timeout_sec, int *pStatus);
+static void *serve_connection(void *arg);
+static int native_losetup(int argc, char **argv, int out_fd, int err_fd);
+static int native_mountwrap(int argc, char **argv, int out_fd, int err_fd);
+#ifdef HAVE_LIBDEVMAPPER
+static int native_dmsetup(int argc, char **argv, int out_fd, int err_fd);
+#endif /* HAVE_LIBDEVMAPPER */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! The commands the helper accepts. Everything else is denied.
+static const privd_command allowed_commands[] = {
+    {"losetup", native_losetup},
+#ifdef HAVE_LIBDEVMAPPER
+    {"dmsetup", native_dmsetup},
+#else /* HAVE_LIBDEVMAPPER */
+    {"dmsetup", NULL},
+#endif /* HAVE_LIBDEVMAPPER */
+    {"euca_mountwrap", native_mountwrap},
+    {"iptables", NULL},
+    {"iptables-save", NULL},
+    {"iptables-restore", NULL},
+    {"ebtables", NULL},
+    {"ipset", NULL},
+    {"ip", NULL},
+    {"brctl", NULL},
+    {"vconfig", NULL},
+    {"euca_ipt", NULL},
+    {"getstats.pl", NULL},
+    {NULL, NULL},
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Adds the directories of this installation of Eucalyptus, found from the location of the
+//! helper itself, to those commands may be run from
+//!
+static void init_allowed_dirs(void)
+{
+    int len = 0;
+    char exe[EUCA_MAX_PATH] = "";
+    char home[EUCA_MAX_PATH] = "";
+    char *ptr = NULL;
+    const char *suffix = LIBEXECDIR "/eucalyptus";
+
+    if (realpath("/proc/self/exe", exe) == NULL)
+        return;
+    if ((ptr = strrchr(exe, '/')) == NULL)
+        return;
+    *ptr = '\0';
+
+    // $EUCALYPTUS/usr/lib/eucalyptus
+    snprintf(allowed_dirs[allowed_dirs_len++], EUCA_MAX_PATH, "%s/", exe);
+    if (((len = strlen(exe) - strlen(suffix)) >= 0) && !strcmp(exe + len, suffix)) {
+        // $EUCALYPTUS/usr/share/eucalyptus
+        euca_strncpy(home, exe, (len + 1));
+        snprintf(allowed_dirs[allowed_dirs_len++], EUCA_MAX_PATH, EUCALYPTUS_HELPER_DIR "/", home);
+    }
+}
+
+//!
+//! Looks up a command in the allowlist. A command given with a path must resolve to one of
+//! the allowed directories; one without is looked up in $PATH like euca_rootwrap would.
+//!
+//! @param[in] path the command, as argv[0]
+//!
+//! @return the entry of the command or NULL if it is not allowed
+//!
+static const privd_command *find_command(const char *path)
+{
+    int i = 0;
+    char real[PATH_MAX] = "";
+    const char *base = ((strrchr(path, '/') != NULL) ? (strrchr(path, '/') + 1) : path);
+
+    for (i = 0; allowed_commands[i].name && strcmp(allowed_commands[i].name, base); i++) ;
+    if (allowed_commands[i].name == NULL)
+        return (NULL);
+
+    if (strchr(path, '/')) {
+        if (realpath(path, real) == NULL)
+            return (NULL);
+        *(strrchr(real, '/') + 1) = '\0';
+        for (int j = 0; j < allowed_dirs_len; j++) {
+            if (!strcmp(real, allowed_dirs[j]))
+                return (&allowed_commands[i]);
+        }
+        return (NULL);
+    }
+    return (&allowed_commands[i]);
+}
+
+//!
+//! Receives the header of a request along with the descriptors passed with it
+//!
+//! @param[in]  sock the connection
+//! @param[out] req the header
+//! @param[out] fds the descriptors, at most two
+//! @param[out] nfds the number of descriptors received
+//!
+//! @return the size of the header on success, 0 on end of file or -1 on error
+//!
+static int recv_request(int sock, euca_privd_request * req, int *fds, int *nfds)
+{
+    int n = 0;
+    ssize_t bytes = 0;
+    size_t got = 0;
+    char control[CMSG_SPACE(sizeof(int) * 2)] = { 0 };
+    struct iovec iov = { req, sizeof(*req) };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg = NULL;
+
+    *nfds = 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    do {
+        bytes = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while ((bytes < 0) && (errno == EINTR));
+    if (bytes <= 0)
+        return ((int)bytes);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+            n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int i = 0; i < n; i++) {
+                if (*nfds < 2)
+                    fds[(*nfds)++] = ((int *)CMSG_DATA(cmsg))[i];
+                else
+                    close(((int *)CMSG_DATA(cmsg))[i]);
+            }
+        }
+    }
+
+    // the rest of a header split across reads carries no descriptors
+    for (got = bytes; got < sizeof(*req); got += bytes) {
+        if ((bytes = read(sock, ((char *)req) + got, (sizeof(*req) - got))) <= 0) {
+            if ((bytes < 0) && (errno == EINTR)) {
+                bytes = 0;
+                continue;
+            }
+            return (-1);
+        }
+    }
+    return (sizeof(*req));
+}
+
+//!
+//! Sends a reply on a connection
+//!
+//! @param[in] sock the connection
+//! @param[in] type one of privd_reply_type_t
+//! @param[in] result the result of the command, for PRIVD_DONE
+//! @param[in] status the status of the command, for PRIVD_DONE
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int send_reply(int sock, int type, int result, int status)
+{
+    euca_privd_reply reply = { type, result, status };
+
+    return ((write(sock, &reply, sizeof(reply)) == sizeof(reply)) ? 0 : -1);
+}
+
+//!
+//! Waits for a command to complete, killing its process group if it runs for too long
+//!
+//! @param[in]  pid the command
+//! @param[in]  timeout_sec how long it may run, 0 for no limit
+//! @param[out] pStatus set to its status from waitpid()
+//!
+//! @return EUCA_OK, EUCA_ERROR, EUCA_THREAD_ERROR or EUCA_TIMEOUT_ERROR like euca_run()
+//!
+static int wait_command(pid_t pid, int timeout_sec, int *pStatus)
+{
+    int rc = 0;
+    int pidfd = -1;
+    int elapsed_usec = 0;
+    struct pollfd pfd = { 0 };
+
+#ifdef SYS_pidfd_open
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif /* SYS_pidfd_open */
+
+    if ((timeout_sec > 0) && (pidfd >= 0)) {
+        pfd.fd = pidfd;
+        pfd.events = POLLIN;
+        while (((rc = poll(&pfd, 1, (timeout_sec * 1000))) < 0) && (errno == EINTR)) ;
+        rc = ((rc == 0) ? 0 : waitpid(pid, pStatus, 0));
+    } else if (timeout_sec > 0) {
+        while (((rc = waitpid(pid, pStatus, WNOHANG)) == 0) && (elapsed_usec < (timeout_sec * 1000000))) {
+            usleep(PRIVD_WAIT_USEC);
+            elapsed_usec += PRIVD_WAIT_USEC;
+        }
+    } else {
+        while (((rc = waitpid(pid, pStatus, 0)) < 0) && (errno == EINTR)) ;
+    }
+    if (pidfd >= 0)
+        close(pidfd);
+
+    if (rc == 0) {
+        fprintf(stderr, EUCA_PRIVD_NAME ": command %d timed out after %d seconds, killing it\n", pid, timeout_sec);
+        kill(-pid, SIGKILL);
+        kill(pid, SIGKILL);
+        while ((waitpid(pid, pStatus, 0) < 0) && (errno == EINTR)) ;
+        return (EUCA_TIMEOUT_ERROR);
+    } else if (rc < 0) {
+        return (EUCA_THREAD_ERROR);
+    } else if (WIFSIGNALED(*pStatus)) {
+        return (EUCA_THREAD_ERROR);
+    }
+    return ((WEXITSTATUS(*pStatus) == 0) ? EUCA_OK : EUCA_ERROR);
+}
+
+//!
+//! Runs a command the way euca_rootwrap would have, minus the exec of euca_rootwrap
+//!
+//! @param[in]  args the NULL-terminated command line
+//! @param[in]  stdin_path the file to use as stdin, or NULL for none
+//! @param[in]  out_fd the descriptor to use as stdout, or -1 to keep the helper's
+//! @param[in]  err_fd the descriptor to use as stderr, or -1 to keep the helper's
+//! @param[in]  timeout_sec how long the command may run, 0 for no limit
+//! @param[out] pStatus set to its status from waitpid()
+//!
+//! @return EUCA_OK, EUCA_ERROR, EUCA_THREAD_ERROR or EUCA_TIMEOUT_ERROR like euca_run()
+//!
+static int run_command(char **args, const char *stdin_path, int out_fd, int err_fd, int timeout_sec, int *pStatus)
+{
+    extern char **environ;
+    int rc = 0;
+    pid_t pid = -1;
+    sigset_t sigs = { {0} };
+    posix_spawnattr_t attr = { 0 };
+    posix_spawn_file_actions_t actions = { 0 };
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_setflags(&attr, (POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF));
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+
+    // the stdin of the helper is its control socket, which commands must not get
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, (stdin_path ? stdin_path : "/dev/null"), O_RDONLY, 0);
+    if (out_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    if (err_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+
+    rc = posix_spawnp(&pid, args[0], &actions, &attr, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rc != 0) {
+        dprintf(((err_fd >= 0) ? err_fd : STDERR_FILENO), EUCA_PRIVD_NAME ": failed to run %s: %s\n", args[0], strerror(rc));
+        *pStatus = W_EXITCODE(127, 0);
+        return (EUCA_THREAD_ERROR);
+    }
+
+    // the command has its copies of the pipes: let the component see their end of file
+    if (out_fd >= 0)
+        close(out_fd);
+    if (err_fd >= 0)
+        close(err_fd);
+    return (wait_command(pid, timeout_sec, pStatus));
+}
+
+//!
+//! Serves the requests of one connection, one at a time, until the component closes it
+//!
+//! @param[in] arg the connection, cast to a pointer
+//!
+//! @return NULL
+//!
+static void *serve_connection(void *arg)
+{
+    int i = 0;
+    int fd = 0;
+    int nfds = 0;
+    int argc = 0;
+    int code = 0;
+    int status = 0;
+    int result = 0;
+    int out_fd = -1;
+    int err_fd = -1;
+    int fds[2] = { -1, -1 };
+    int sock = (int)((long)arg);
+    char *ptr = NULL;
+    char *end = NULL;
+    char *stdin_path = NULL;
+    char *args[PRIVD_MAX_ARGS + 1] = { NULL };
+    char payload[PRIVD_MAX_PAYLOAD + 1] = "";
+    ssize_t bytes = 0;
+    euca_privd_request req = { 0 };
+    const privd_command *command = NULL;
+
+    while (recv_request(sock, &req, fds, &nfds) > 0) {
+        // sort out the descriptors
+        out_fd = err_fd = -1;
+        for (i = 0, fd = 0; fd < nfds; i++) {
+            if ((i == 0) && (req.fds & PRIVD_FD_STDOUT))
+                out_fd = fds[fd++];
+            else if ((i == 1) && (req.fds & PRIVD_FD_STDERR))
+                err_fd = fds[fd++];
+            else if (i > 1)
+                close(fds[fd++]);
+        }
+
+        // read and split the payload
+        if ((req.len < 0) || (req.len > PRIVD_MAX_PAYLOAD) || (req.nargs < 1) || (req.nargs > PRIVD_MAX_ARGS))
+            break;
+        for (i = 0; i < req.len; i += bytes) {
+            if ((bytes = read(sock, payload + i, (req.len - i))) <= 0) {
+                if ((bytes < 0) && (errno == EINTR)) {
+                    bytes = 0;
+                    continue;
+                }
+                break;
+            }
+        }
+        if (i < req.len)
+            break;
+        payload[req.len] = '\0';
+
+        end = payload + req.len;
+        for (argc = 0, ptr = payload; (argc < req.nargs) && (ptr < end); ptr += strlen(ptr) + 1)
+            args[argc++] = ptr;
+        args[argc] = NULL;
+        stdin_path = (((ptr < end) && (*ptr != '\0')) ? ptr : NULL);
+
+        if ((argc != req.nargs) || ((command = find_command(args[0])) == NULL)) {
+            send_reply(sock, PRIVD_DENIED, EUCA_PERMISSION_ERROR, 0);
+        } else if (send_reply(sock, PRIVD_ACCEPTED, EUCA_OK, 0) == 0) {
+            code = NATIVE_UNHANDLED;
+            if (command->native && (stdin_path == NULL)) {
+                code = command->native(argc, args, ((out_fd >= 0) ? out_fd : STDOUT_FILENO), ((err_fd >= 0) ? err_fd : STDERR_FILENO));
+            }
+
+            if (code == NATIVE_UNHANDLED) {
+                result = run_command(args, stdin_path, out_fd, err_fd, req.timeout_sec, &status);
+                out_fd = err_fd = -1;
+            } else {
+                status = W_EXITCODE(code, 0);
+                result = ((code == 0) ? EUCA_OK : EUCA_ERROR);
+            }
+
+            if (out_fd >= 0)
+                close(out_fd);
+            if (err_fd >= 0)
+                close(err_fd);
+            out_fd = err_fd = -1;
+            send_reply(sock, PRIVD_DONE, result, status);
+        }
+
+        if (out_fd >= 0)
+            close(out_fd);
+        if (err_fd >= 0)
+            close(err_fd);
+    }
+
+    if (out_fd >= 0)
+        close(out_fd);
+    if (err_fd >= 0)
+        close(err_fd);
+    close(sock);
+    return (NULL);
+}
+
+//!
+//! The forms of losetup that diskutil uses, through the loop ioctls. Messages mimic those of
+//! losetup, which callers look for (e.g. "No such device or address").
+//!
+//! @param[in] argc
+//! @param[in] argv
+//! @param[in] out_fd where the command writes its output
+//! @param[in] err_fd where the command writes its errors
+//!
+//! @return the exit code or NATIVE_UNHANDLED
+//!
+static int native_losetup(int argc, char **argv, int out_fd, int err_fd)
+{
+    int fd = -1;
+    int ctl = -1;
+    int num = -1;
+    int file = -1;
+    int ret = 0;
+    char *end = NULL;
+    long long offset = 0;
+    struct loop_info64 info = { 0 };
+
+    if ((argc == 2) && !strcmp(argv[1], "-f")) {
+        // losetup -f: first unused device
+        if ((ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC)) < 0)
+            return (NATIVE_UNHANDLED);
+        num = ioctl(ctl, LOOP_CTL_GET_FREE);
+        close(ctl);
+        if (num < 0)
+            return (NATIVE_UNHANDLED);
+        dprintf(out_fd, "/dev/loop%d\n", num);
+        return (0);
+    }
+
+    if ((argc == 3) && !strcmp(argv[1], "-d")) {
+        // losetup -d DEV: detach
+        if (((fd = open(argv[2], O_RDONLY | O_CLOEXEC)) < 0) || (ioctl(fd, LOOP_CLR_FD, 0) != 0)) {
+            dprintf(err_fd, "losetup: %s: %s\n", argv[2], strerror(errno));
+            ret = 1;
+        }
+        if (fd >= 0)
+            close(fd);
+        return (ret);
+    }
+
+    if ((argc == 5) && !strcmp(argv[1], "-o")) {
+        // losetup -o OFFSET DEV FILE: attach
+        offset = strtoll(argv[2], &end, 10);
+        if ((*argv[2] == '\0') || (*end != '\0') || (offset < 0))
+            return (NATIVE_UNHANDLED);
+
+        info.lo_offset = offset;
+        euca_strncpy((char *)info.lo_file_name, argv[4], LO_NAME_SIZE);
+        if ((file = open(argv[4], O_RDWR | O_CLOEXEC)) < 0) {
+            if ((file = open(argv[4], O_RDONLY | O_CLOEXEC)) >= 0)
+                info.lo_flags |= LO_FLAGS_READ_ONLY;
+        }
+
+        if (file < 0) {
+            dprintf(err_fd, "losetup: %s: %s\n", argv[4], strerror(errno));
+            ret = 1;
+        } else if ((fd = open(argv[3], (((info.lo_flags & LO_FLAGS_READ_ONLY) ? O_RDONLY : O_RDWR) | O_CLOEXEC))) < 0) {
+            dprintf(err_fd, "losetup: %s: %s\n", argv[3], strerror(errno));
+            ret = 1;
+        } else if (ioctl(fd, LOOP_SET_FD, file) != 0) {
+            dprintf(err_fd, "losetup: %s: failed to set up loop device: %s\n", argv[3], strerror(errno));
+            ret = 1;
+        } else if (ioctl(fd, LOOP_SET_STATUS64, &info) != 0) {
+            dprintf(err_fd, "losetup: %s: failed to set up loop device: %s\n", argv[3], strerror(errno));
+            ioctl(fd, LOOP_CLR_FD, 0);
+            ret = 1;
+        }
+
+        if (fd >= 0)
+            close(fd);
+        if (file >= 0)
+            close(file);
+        return (ret);
+    }
+
+    if ((argc == 2) && (argv[1][0] != '-')) {
+        // losetup DEV: status, as in "/dev/loop4: [0801]:5509589 (/var/lib/eucalyptus/volumes/v*)"
+        if (((fd = open(argv[1], O_RDONLY | O_CLOEXEC)) < 0) || (ioctl(fd, LOOP_GET_STATUS64, &info) != 0)) {
+            dprintf(err_fd, "losetup: %s: %s\n", argv[1], strerror(errno));
+            ret = 1;
+        } else {
+            info.lo_file_name[LO_NAME_SIZE - 1] = '\0';
+            dprintf(out_fd, "%s: [%04llu]:%llu (%s%s)\n", argv[1], (unsigned long long)info.lo_device, (unsigned long long)info.lo_inode, info.lo_file_name,
+                    ((strlen((char *)info.lo_file_name) == (LO_NAME_SIZE - 1)) ? "*" : ""));
+        }
+        if (fd >= 0)
+            close(fd);
+        return (ret);
+    }
+
+    return (NATIVE_UNHANDLED);
+}
+
+//!
+//! What euca_mountwrap does, without its exec
+//!
+//! @param[in] argc
+//! @param[in] argv
+//! @param[in] out_fd where the command writes its output
+//! @param[in] err_fd where the command writes its errors
+//!
+//! @return the exit code or NATIVE_UNHANDLED
+//!
+static int native_mountwrap(int argc, char **argv, int out_fd, int err_fd)
+{
+    int rc = -1;
+    char *filesystems[] = { "ext4", "ext3", "ext2" };   // file systems to try, in that order
+    struct passwd pwd = { 0 };
+    struct passwd *pass = NULL;
+    char buf[16384] = "";
+
+    if ((argc >= 4) && !strcmp(argv[1], "mount")) {
+        if ((argc > 4) && !strcmp(argv[4], "--bind")) {
+            if (mount(argv[2], argv[3], NULL, MS_BIND, NULL) != 0) {
+                dprintf(err_fd, "mount: %s\n", strerror(errno));
+                return (1);
+            }
+            return (0);
+        }
+
+        for (u_int i = 0; (rc != 0) && (i < (sizeof(filesystems) / sizeof(char *))); i++) {
+            if ((rc = mount(argv[2], argv[3], filesystems[i], MS_MGC_VAL, NULL)) != 0)
+                dprintf(err_fd, "mount: %s\n", strerror(errno));
+        }
+        if (rc != 0)
+            return (1);
+
+        if (argc > 4) {
+            // extra parameter is the username to chown the target to
+            if ((getpwnam_r(argv[4], &pwd, buf, sizeof(buf), &pass) != 0) || (pass == NULL)) {
+                dprintf(err_fd, "getpwnam: %s: no such user\n", argv[4]);
+                return (1);
+            }
+            if (chown(argv[3], pass->pw_uid, (gid_t) - 1) != 0) {
+                dprintf(err_fd, "chown: %s\n", strerror(errno));
+                return (1);
+            }
+        }
+        return (0);
+    }
+
+    if ((argc == 3) && !strcmp(argv[1], "umount")) {
+        if (umount(argv[2]) != 0) {
+            dprintf(err_fd, "umount: %s\n", strerror(errno));
+            return (1);
+        }
+        return (0);
+    }
+
+    return (NATIVE_UNHANDLED);
+}
+
+#ifdef HAVE_LIBDEVMAPPER
+//!
+//! The forms of dmsetup that the blobstore uses (create from a table file, remove, suspend
+//! and resume), through libdevmapper
+//!
+//! @param[in] argc
+//! @param[in] argv
+//! @param[in] out_fd where the command writes its output
+//! @param[in] err_fd where the command writes its errors
+//!
+//! @return the exit code or NATIVE_UNHANDLED
+//!
+static int native_dmsetup(int argc, char **argv, int out_fd, int err_fd)
+{
+    int ret = 0;
+    int type = 0;
+    int used = 0;
+    uint32_t cookie = 0;
+    unsigned long long start = 0;
+    unsigned long long length = 0;
+    char line[4096] = "";
+    char target[64] = "";
+    FILE *fp = NULL;
+    struct dm_task *dmt = NULL;
+
+    if ((argc == 4) && !strcmp(argv[1], "create"))
+        type = DM_DEVICE_CREATE;
+    else if ((argc == 3) && !strcmp(argv[1], "remove"))
+        type = DM_DEVICE_REMOVE;
+    else if ((argc == 3) && !strcmp(argv[1], "suspend"))
+        type = DM_DEVICE_SUSPEND;
+    else if ((argc == 3) && !strcmp(argv[1], "resume"))
+        type = DM_DEVICE_RESUME;
+    else
+        return (NATIVE_UNHANDLED);
+
+    if (((dmt = dm_task_create(type)) == NULL) || !dm_task_set_name(dmt, argv[2])) {
+        dprintf(err_fd, "device-mapper: %s %s: failed to set up the task\n", argv[1], argv[2]);
+        ret = 1;
+    }
+
+    if ((ret == 0) && (type == DM_DEVICE_CREATE)) {
+        if ((fp = fopen(argv[3], "re")) == NULL) {
+            dprintf(err_fd, "dmsetup: %s: %s\n", argv[3], strerror(errno));
+            ret = 1;
+        }
+        while ((ret == 0) && fp && fgets(line, sizeof(line), fp)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            if ((sscanf(line, "%llu %llu %63s %n", &start, &length, target, &used) < 3) || !dm_task_add_target(dmt, start, length, target, line + used)) {
+                dprintf(err_fd, "device-mapper: %s: invalid table line '%s'\n", argv[2], line);
+                ret = 1;
+            }
+        }
+        if (fp)
+            fclose(fp);
+    }
+
+    if ((ret == 0) && (type == DM_DEVICE_REMOVE) && !dm_task_retry_remove(dmt)) {
+        ret = 1;
+    }
+    if ((ret == 0) && (type != DM_DEVICE_SUSPEND) && !dm_task_set_cookie(dmt, &cookie, 0)) {
+        ret = 1;
+    }
+    if ((ret == 0) && !dm_task_run(dmt)) {
+        dprintf(err_fd, "device-mapper: %s ioctl on %s failed\n", argv[1], argv[2]);
+        ret = 1;
+    }
+    if (cookie && !dm_udev_wait(cookie)) {
+        ret = 1;
+    }
+    if (dmt)
+        dm_task_destroy(dmt);
+    return (ret);
+}
+#endif /* HAVE_LIBDEVMAPPER */
+
+//!
+//! Main entry point of the application. Expects the control socket as stdin and serves each
+//! connection passed over it in a thread of its own, until the component closes the socket.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return 0 when the component goes away or 1 on failure
+//!
+int main(int argc, char **argv)
+{
+    int nfds = 0;
+    int fds[2] = { -1, -1 };
+    euca_privd_request req = { 0 };
+    pthread_t thread = { 0 };
+    pthread_attr_t attr = { {0} };
+
+    if (geteuid() != 0) {
+        fprintf(stderr, EUCA_PRIVD_NAME ": must be started through euca_rootwrap\n");
+        exit(1);
+    }
+
+    if (setresgid(((gid_t) 0), ((gid_t) 0), ((gid_t) 0))) {
+        perror("setresgid");
+    }
+    if (setresuid(((uid_t) 0), ((uid_t) 0), ((uid_t) 0))) {
+        perror("setresuid");
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    init_allowed_dirs();
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    // each message on the control socket is an empty request carrying a new connection
+    while (recv_request(STDIN_FILENO, &req, fds, &nfds) > 0) {
+        for (int i = 0; i < nfds; i++) {
+            if (pthread_create(&thread, &attr, serve_connection, ((void *)((long)fds[i]))) != 0) {
+                close(fds[i]);
+            }
+        }
+    }
+
+    exit(0);
+}
@@ -0,0 +1,130 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_EUCA_PROBE_H_
+#define _INCLUDE_EUCA_PROBE_H_
+
+//!
+//! @file util/euca_probe.h
+//! Static tracepoints (USDT) on the hot paths of the components, for live latency analysis
+//! with bpftrace, perf or SystemTap, e.g.:
+//!
+//!     bpftrace -e 'usdt:/usr/sbin/eucalyptus-nc:eucalyptus:hyp__lock__acquired { @[ustack] = count(); }'
+//!
+//! When the tree is built with <sys/sdt.h> (systemtap-sdt-devel), each probe is a single nop
+//! in the code, plus a note in the ELF file that the tracers use to find it and its arguments;
+//! the arguments are only read when a tracer attaches. Without the header, the probes compile
+//! to nothing. Probe arguments must therefore be free of side effects.
+//!
+//! The probes of the provider "eucalyptus":
+//!     nc__call__start(op, url) and nc__call__done(op, url, rc): an ncClientCall() from the CC
+//!     refresh__instances__start(nodes) and refresh__instances__done(nodes, seconds): a CC poll of the NCs
+//!     blob__open__start(id, flags) and blob__open__done(id, rc): blockblob_open()
+//!     blob__clone__start(id, map_size) and blob__clone__done(id, rc): blockblob_clone()
+//!     blob__purge__start(need_blocks) and blob__purge__done(purged_blocks): an LRU purge of the blobstore
+//!     vbr__create__start(id) and vbr__create__done(id, rc): a VBR artifact creator
+//!     hyp__lock__wait and hyp__lock__acquired(ok) and hyp__lock__released: lock_hypervisor_conn()
+//!     sem__wait__start(name) and sem__wait__done(name, rc): sem_prolaag()
+//!     ipt__deploy__start and ipt__deploy__done(rc): ipt_handler_deploy() in eucanetd
+//!     gni__populate__start(path) and gni__populate__done(path, rc): gni_populate() in eucanetd
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <eucalyptus-config.h>         // HAVE_SYS_SDT_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif /* HAVE_SYS_SDT_H */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! @{
+//! @name Probe macros
+//! Fire a probe of the "eucalyptus" provider, with up to four integer or pointer arguments
+#ifdef HAVE_SYS_SDT_H
+#define EUCA_PROBE(_name)                        DTRACE_PROBE(eucalyptus, _name)
+#define EUCA_PROBE1(_name, _a1)                  DTRACE_PROBE1(eucalyptus, _name, (_a1))
+#define EUCA_PROBE2(_name, _a1, _a2)             DTRACE_PROBE2(eucalyptus, _name, (_a1), (_a2))
+#define EUCA_PROBE3(_name, _a1, _a2, _a3)        DTRACE_PROBE3(eucalyptus, _name, (_a1), (_a2), (_a3))
+#define EUCA_PROBE4(_name, _a1, _a2, _a3, _a4)   DTRACE_PROBE4(eucalyptus, _name, (_a1), (_a2), (_a3), (_a4))
+#else /* HAVE_SYS_SDT_H */
+#define EUCA_PROBE(_name)                        do { } while (0)
+#define EUCA_PROBE1(_name, _a1)                  do { } while (0)
+#define EUCA_PROBE2(_name, _a1, _a2)             do { } while (0)
+#define EUCA_PROBE3(_name, _a1, _a2, _a3)        do { } while (0)
+#define EUCA_PROBE4(_name, _a1, _a2, _a3, _a4)   do { } while (0)
+#endif /* HAVE_SYS_SDT_H */
+//! @}
+
+#endif /* ! _INCLUDE_EUCA_PROBE_H_ */
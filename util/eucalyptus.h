@@ -79,6 +79,10 @@
 
 #include <stdint.h>
 
+#ifdef EUCA_ALLOC_TRACKING
+#include "euca_alloc.h"
+#endif /* EUCA_ALLOC_TRACKING */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -182,6 +186,7 @@
 
 #define NC_NET_PATH_DEFAULT                      EUCALYPTUS_RUN_DIR "/net"
 #define CC_NET_PATH_DEFAULT                      EUCALYPTUS_RUN_DIR "/net"
+#define EUCANETD_NOTIFY_SOCKET                   EUCALYPTUS_RUN_DIR "/eucanetd.sock"    //!< datagram socket eucanetd listens on for new network info versions
 
 #define EUCALYPTUS_STATS_OUTPUT_DIR              EUCALYPTUS_RUN_DIR "/status"
 #define EUCALYPTUS_STATS_CONF_PATH               EUCALYPTUS_CONF_DIR "/stats.conf"
@@ -214,14 +219,40 @@
 #define CONFIG_HYPERVISOR                       "HYPERVISOR"
 #define CONFIG_NC_CACHE_SIZE                    "NC_CACHE_SIZE"
 #define CONFIG_NC_WORK_SIZE                     "NC_WORK_SIZE"
+#define CONFIG_NC_FAST_CACHE_PATH               "NC_FAST_CACHE_PATH"
+#define CONFIG_NC_FAST_CACHE_SIZE               "NC_FAST_CACHE_SIZE"
 #define CONFIG_NC_OVERHEAD_SIZE                 "NC_WORK_OVERHEAD_SIZE"
 #define CONFIG_NC_SWAP_SIZE                     "SWAP_SIZE"
 #define CONFIG_SAVE_INSTANCES                   "MANUAL_INSTANCES_CLEANUP"
 #define CONFIG_CONCURRENT_DISK_OPS              "CONCURRENT_DISK_OPS"
 #define CONFIG_SC_REQUEST_TIMEOUT               "SC_REQUEST_TIMEOUT"
+#define CONFIG_SC_CONNECTION_POOL               "SC_CONNECTION_POOL"
+#define CONFIG_CREATEIMAGE_LIVE                 "CREATE_IMAGE_LIVE"
 #define CONFIG_CONCURRENT_CLEANUP_OPS           "CONCURRENT_CLEANUP_OPS"
+#define CONFIG_CONCURRENT_LAUNCH_FETCH          "CONCURRENT_LAUNCH_FETCH"
+#define CONFIG_CONCURRENT_LAUNCH_PREPARE        "CONCURRENT_LAUNCH_PREPARE"
+#define CONFIG_CONCURRENT_LAUNCH_DEFINE         "CONCURRENT_LAUNCH_DEFINE"
+#define CONFIG_CONCURRENT_LAUNCH_BOOT           "CONCURRENT_LAUNCH_BOOT"
+#define CONFIG_NUMA_PINNING                     "NC_NUMA_PINNING"
+#define CONFIG_HUGE_PAGES                       "NC_HUGE_PAGES"
+#define CONFIG_MEMORY_DENSITY                   "NC_MEMORY_DENSITY"
+#define CONFIG_MEMORY_OVERCOMMIT                "NC_MEMORY_OVERCOMMIT_RATIO"
 #define CONFIG_DISABLE_SNAPSHOTS                "DISABLE_CACHE_SNAPSHOTS"
+#define CONFIG_THIN_SNAPSHOTS                   "USE_THIN_SNAPSHOTS"
+#define CONFIG_RECLAIM_SPARSE_BLOCKS            "RECLAIM_SPARSE_BLOCKS"
+#define CONFIG_CACHE_IO_POLICY                  "CACHE_IO_POLICY"
+#define CONFIG_WORK_IO_POLICY                   "WORK_IO_POLICY"
+#define CONFIG_PRESTAGE_BANDWIDTH               "IMAGE_PRESTAGE_BANDWIDTH"
+#define CONFIG_LAZY_BOOT                        "LAZY_BOOT_URL_IMAGES"
+#define CONFIG_LAZY_PULL_BANDWIDTH              "LAZY_BOOT_PULL_BANDWIDTH"
+#define CONFIG_COMPRESS_CACHED_IMAGES           "COMPRESS_CACHED_IMAGES"
+#define CONFIG_STREAM_IMAGE_DOWNLOADS           "STREAM_IMAGE_DOWNLOADS"
 #define CONFIG_USE_VIRTIO_NET                   "USE_VIRTIO_NET"
+#define CONFIG_VIRTIO_NET_QUEUES                "VIRTIO_NET_QUEUES"
+#define CONFIG_VIRTIO_NET_RING_SIZE             "VIRTIO_NET_RING_SIZE"
+#define CONFIG_VIRTIO_IOTHREADS                 "VIRTIO_IOTHREADS"
+#define CONFIG_VIRTIO_TUNED_VM_TYPES            "VIRTIO_TUNED_VM_TYPES"
+#define CONFIG_INSTANCE_QOS                     "INSTANCE_QOS"
 #define CONFIG_USE_VIRTIO_DISK                  "USE_VIRTIO_DISK"
 #define CONFIG_USE_VIRTIO_ROOT                  "USE_VIRTIO_ROOT"
 #define CONFIG_NC_BUNDLE_UPLOAD                 "NC_BUNDLE_UPLOAD_PATH"
@@ -233,9 +264,18 @@
 #define CONFIG_NC_CREATEIMAGE_CLEANUP_THRESHOLD "NC_CREATEIMAGE_CLEANUP_THRESHOLD"
 #define CONFIG_NC_TEARDOWN_STATE_DURATION       "NC_TEARDOWN_STATE_DURATION"
 #define CONFIG_NC_MIGRATION_READY_THRESHOLD     "NC_MIGRATION_READY_THRESHOLD"
+#define CONFIG_NC_MIGRATION_MAX_OUTGOING        "NC_MIGRATION_MAX_OUTGOING"
+#define CONFIG_NC_MIGRATION_BANDWIDTH           "NC_MIGRATION_BANDWIDTH_MBS"
+#define CONFIG_NC_MIGRATION_AUTO_CONVERGE       "NC_MIGRATION_AUTO_CONVERGE"
+#define CONFIG_NC_MIGRATION_COMPRESSION         "NC_MIGRATION_COMPRESSION"
+#define CONFIG_NC_MIGRATION_POSTCOPY_AFTER      "NC_MIGRATION_POSTCOPY_AFTER_SEC"
+#define CONFIG_NC_MIGRATION_KEYS_TTL            "NC_MIGRATION_KEYS_TTL_SEC"
 #define CONFIG_SHUTDOWN_GRACE_PERIOD_SEC        "NC_SHUTDOWN_GRACE_PERIOD_SEC"
 #define CONFIG_ENABLE_WS_SECURITY				"ENABLE_WS_SECURITY"
 #define CONFIG_WALRUS_DOWNLOAD_MAX_ATTEMPTS     "WALRUS_DOWNLOAD_MAX_ATTEMPTS"
+#define CONFIG_DIGEST_CACHE_TTL                 "IMAGE_DIGEST_CACHE_TTL"
+#define CONFIG_DOWNLOAD_STREAMS                 "IMAGE_DOWNLOAD_STREAMS"
+#define CONFIG_IMAGE_PEERS                      "IMAGE_PEERS"
 #define CONFIG_NC_CEPH_USER                     "CEPH_USER_NAME"
 #define CONFIG_NC_CEPH_KEYS                     "CEPH_KEYRING_PATH"
 #define CONFIG_NC_CEPH_CONF                     "CEPH_CONFIG_PATH"
@@ -495,6 +535,13 @@ extern const char *euca_error_names[];
 #define EUCA_ERROR_NAME(_error)                  (((_error) > EUCA_LAST_ERROR) ? euca_error_names[EUCA_LAST_ERROR] : euca_error_names[(_error)])
 #endif /* ! EUCA_ERROR_NAME */
 
+#ifdef EUCA_ALLOC_TRACKING
+//! With allocation tracking, each call site counts its allocations, see euca_alloc.h
+#define EUCA_ALLOC(_nmemb, _size)                EUCA_TRACKED_ALLOC((_nmemb), (_size))
+#define EUCA_ZALLOC(_nmemb, _size)               EUCA_TRACKED_ZALLOC((_nmemb), (_size))
+#define EUCA_REALLOC(_ptr, _nmemb, _size)        EUCA_TRACKED_REALLOC((_ptr), (_nmemb), (_size))
+#endif /* EUCA_ALLOC_TRACKING */
+
 #ifndef EUCA_ALLOC
 //! Macro for fast (non-zeroed) memory allocation
 #define EUCA_ALLOC(_nmemb, _size)                malloc((_nmemb) * (_size))
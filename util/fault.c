@@ -102,6 +102,7 @@
 #include "wc.h"
 #include "utf8.h"
 #include "euca_string.h"
+#include "hash.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -121,6 +122,8 @@
 #define LOCALIZED_TAG                            "localized"
 #define MESSAGE_TAG                              "message"
 #define STANDARD_FILESTREAM                      stderr
+#define NUM_FAULT_LABELS                         5  //!< Number of labelled lines in a fault log entry
+#define FAULT_SET_MIN_SLOTS                      64 //!< Initial number of slots of a fault_set
 
 //! @{
 //! @name for ourput formatting
@@ -161,11 +164,21 @@ enum faultdir_types {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-//! Linked list of faults being deliberately suppressed.
-struct suppress_list {
-    char *id;                          //!< Fault identifier string
-    struct suppress_list *next;        //!< Pointer to the next fault in line
-};
+//! Open-addressed set of strings, for the faults being suppressed or already logged.
+typedef struct fault_set_t {
+    u32 size;                          //!< Number of slots, a power of 2 (0 until the first insert)
+    u32 count;                         //!< Number of strings in the set
+    char **keys;                       //!< The strings, or NULL for free slots
+    u64 *hashes;                       //!< euca_hash64_str() of each string
+} fault_set;
+
+//! Precompiled form of one fault of the registry.
+typedef struct fault_entry_t {
+    char *id;                          //!< Fault identifier string, in lower case, or NULL for free slots
+    u64 hash;                          //!< euca_hash64_str() of the identifier
+    char_template *message;            //!< The fault's headline, compiled by c_varsub_compile(), or NULL if it has none
+    char_template *labels[NUM_FAULT_LABELS];    //!< The text for each of fault_labels[], NULL if missing
+} fault_entry;
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -191,7 +204,7 @@ extern char *program_invocation_short_name;
 \*----------------------------------------------------------------------------*/
 
 //! Defines the order of labels in fault log entries.
-static char *fault_labels[] = { "condition",
+static char *fault_labels[NUM_FAULT_LABELS + 1] = { "condition",
     "cause",
     "initiator",
     "location",
@@ -211,11 +224,21 @@ static pthread_mutex_t fault_mutex = PTHREAD_MUTEX_INITIALIZER;
  //! base install directory ($EUCALYPTUS) or empty if root
 static char euca_base[PATH_MAX] = "";
 
-//! Pointer to the suppressed fault list
-static struct suppress_list *suppressed = NULL;
+//! Faults being deliberately suppressed, only modified while the registry is loaded
+static fault_set suppressed = { 0 };
+
+//! Faults already logged with the same parameters, guarded by fault_mutex
+static fault_set redundant = { 0 };
+
+//! Index of the precompiled registry, a table of fault_index_size slots (a power of 2)
+//! built by build_fault_index() and read-only afterwards, so lookups need no lock.
+static fault_entry *fault_index = NULL;
+static u32 fault_index_size = 0;
 
-//! Pointer to the redundant fault list
-static struct suppress_list *redundant = NULL;
+//! Labels from the \<common\> block for each of fault_labels[], and the "unknown" one
+static char *common_labels[NUM_FAULT_LABELS] = { NULL };
+static int common_label_padding[NUM_FAULT_LABELS] = { 0 };  //!< Padding that right-aligns each label
+static char *common_unknown = NULL;
 
 #ifdef EUCA_GENERATE_FAULT
 //! Name of this component
@@ -234,6 +257,8 @@ static int scandir_filter(const struct dirent *entry);
 #ifndef HAVE_XMLFIRSTELEMENTCHILD
 static xmlNodePtr xmlFirstElementChild(xmlNodePtr parent);
 #endif /* ! HAVE_XMLFIRSTELEMENTCHILD */
+static boolean fault_set_contains(const fault_set * set, const char *key, u64 hash);
+static boolean fault_set_add(fault_set * set, char *key, u64 hash);
 static boolean is_suppressed_eucafault(const char *fault_id);
 static boolean check_eucafault_suppression(const char *fault_id, const char *fault_file);
 static xmlDoc *read_eucafault(const char *faultdir, const char *fault_id);
@@ -244,6 +269,11 @@ static xmlNode *get_eucafault(const char *fault_id, const xmlDoc * doc);
 static boolean initialize_faultlog(const char *fileprefix);
 static char *get_common_var(const char *var);
 static char *get_fault_var(const char *var, const xmlNode * f_node);
+static boolean fault_id_key(const char *fault_id, char *key, size_t key_size);
+static char_template *compile_fault_var(char *text);
+static int build_fault_index(void);
+static const fault_entry *find_fault_entry(const char *fault_id);
+static void print_fault_var(const char_template * t, const char_map ** map);
 static boolean format_eucafault(const char *fault_id, const char_map ** map);
 
 #ifdef _UNIT_TEST
@@ -352,6 +382,78 @@ static xmlNodePtr xmlFirstElementChild(xmlNodePtr parent)
 
 //!
 //!
+//!
+//! Checks whether a string is in a set.
+//!
+//! @param[in] set the set to look in
+//! @param[in] key the string to look for
+//! @param[in] hash euca_hash64_str() of key
+//!
+//! @return TRUE if key is in the set, FALSE otherwise.
+//!
+static boolean fault_set_contains(const fault_set * set, const char *key, u64 hash)
+{
+    u32 i = 0;
+
+    if (set->size == 0)
+        return FALSE;
+
+    for (i = hash & (set->size - 1); set->keys[i] != NULL; i = (i + 1) & (set->size - 1)) {
+        if ((set->hashes[i] == hash) && !strcmp(set->keys[i], key))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+//!
+//! Adds a string, which must not already be in it, to a set, doubling the set when it
+//! gets half full.
+//!
+//! @param[in] set the set to add to
+//! @param[in] key the string to add; the set takes ownership of it
+//! @param[in] hash euca_hash64_str() of key
+//!
+//! @return TRUE if the string was added, FALSE on memory allocation failure (key is
+//!         then still owned by the caller).
+//!
+static boolean fault_set_add(fault_set * set, char *key, u64 hash)
+{
+    u32 i = 0;
+    u32 j = 0;
+    u32 size = 0;
+    char **keys = NULL;
+    u64 *hashes = NULL;
+
+    if (((set->count + 1) * 2) > set->size) {
+        size = ((set->size) ? (set->size * 2) : FAULT_SET_MIN_SLOTS);
+        keys = EUCA_ZALLOC(size, sizeof(char *));
+        hashes = EUCA_ZALLOC(size, sizeof(u64));
+        if ((keys == NULL) || (hashes == NULL)) {
+            EUCA_FREE(keys);
+            EUCA_FREE(hashes);
+            return FALSE;
+        }
+        for (i = 0; i < set->size; i++) {
+            if (set->keys[i] != NULL) {
+                for (j = set->hashes[i] & (size - 1); keys[j] != NULL; j = (j + 1) & (size - 1)) ;
+                keys[j] = set->keys[i];
+                hashes[j] = set->hashes[i];
+            }
+        }
+        EUCA_FREE(set->keys);
+        EUCA_FREE(set->hashes);
+        set->keys = keys;
+        set->hashes = hashes;
+        set->size = size;
+    }
+
+    for (i = hash & (set->size - 1); set->keys[i] != NULL; i = (i + 1) & (set->size - 1)) ;
+    set->keys[i] = key;
+    set->hashes[i] = hash;
+    set->count++;
+    return TRUE;
+}
+
 //!
 //! @param[in] fault_id
 //!
@@ -363,14 +465,10 @@ static boolean is_suppressed_eucafault(const char *fault_id)
         LOGWARN("called with NULL argument...ignoring.\n");
         return FALSE;
     }
-    struct suppress_list *suppose = suppressed;
 
-    while (suppose) {
-        if (!strcmp(fault_id, suppose->id)) {
-            LOGTRACE("returning TRUE for %s.\n", fault_id);
-            return TRUE;
-        }
-        suppose = suppose->next;
+    if (fault_set_contains(&suppressed, fault_id, euca_hash64_str(fault_id))) {
+        LOGTRACE("returning TRUE for %s.\n", fault_id);
+        return TRUE;
     }
     LOGTRACE("returning FALSE for %s.\n", fault_id);
     return FALSE;
@@ -414,20 +512,17 @@ static boolean check_eucafault_suppression(const char *fault_id, const char *fau
         if (st.st_size == 0) {
             LOGINFO("Suppressing fault id %s.\n", fault_id);
 
-            struct suppress_list *new_supp = ((struct suppress_list *)EUCA_ZALLOC(1, sizeof(struct suppress_list)));
+            char *new_supp = strdup(fault_id);
 
             if (new_supp == NULL) {
-                LOGERROR("struct malloc() failed in check_eucafault_suppression while adding suppressed fault %s.\n", fault_id);
+                LOGERROR("string malloc() failed in check_eucafault_suppression while adding suppressed fault %s.\n", fault_id);
                 return FALSE;
             }
-            if ((new_supp->id = (char *)strdup(fault_id)) == NULL) {
-                LOGERROR("string malloc() failed in check_eucafault_suppression while adding suppressed fault %s.\n", fault_id);
+            if (!fault_set_add(&suppressed, new_supp, euca_hash64_str(new_supp))) {
+                LOGERROR("malloc() failed in check_eucafault_suppression while adding suppressed fault %s.\n", fault_id);
                 EUCA_FREE(new_supp);
                 return FALSE;
             }
-            // Insert at beginning of list.
-            new_supp->next = suppressed;
-            suppressed = new_supp;
             return TRUE;
         } else {
             return FALSE;
@@ -733,6 +828,9 @@ int init_eucafaults(const char *fileprefix)
             }
         }
     }
+    if (faults_loaded) {
+        build_fault_index();
+    }
     pthread_mutex_unlock(&fault_mutex);
     LOGDEBUG("Loaded %d eucafault descriptions into registry.\n", faults_loaded);
     return faults_loaded;
@@ -845,6 +943,172 @@ static char *get_fault_var(const char *var, const xmlNode * f_node)
     return NULL;
 }
 
+//!
+//! Makes the key a fault identifier is indexed under: fault ids are matched without
+//! regard to case, so the key is the id in lower case.
+//!
+//! @param[in]  fault_id the fault identifier string
+//! @param[out] key buffer for the key
+//! @param[in]  key_size size of the key buffer
+//!
+//! @return TRUE if the key fit in the buffer, FALSE otherwise.
+//!
+static boolean fault_id_key(const char *fault_id, char *key, size_t key_size)
+{
+    size_t i = 0;
+
+    for (i = 0; fault_id[i] != '\0'; i++) {
+        if (i >= (key_size - 1))
+            return FALSE;
+        key[i] = tolower((unsigned char)fault_id[i]);
+    }
+    key[i] = '\0';
+    return TRUE;
+}
+
+//!
+//! Compiles a message of the registry for c_varsub_render().
+//!
+//! @param[in] text the message, as returned by get_fault_var(), which is freed
+//!
+//! @return the compiled message or NULL if text is NULL or on memory allocation failure
+//!
+static char_template *compile_fault_var(char *text)
+{
+    char_template *t = NULL;
+
+    if (text != NULL) {
+        t = c_varsub_compile(text);
+        EUCA_FREE(text);
+    }
+    return t;
+}
+
+//!
+//! Builds the index of the fault registry, with every message compiled by c_varsub_compile(),
+//! along with the \<common\> labels and their alignment. Called by init_eucafaults(), with
+//! fault_mutex held, once all the fault files are loaded.
+//!
+//! @return the number of faults indexed
+//!
+static int build_fault_index(void)
+{
+    int i = 0;
+    int nfaults = 0;
+    int label_len = 0;
+    int max_label_len = 0;
+    int w_label_len[NUM_FAULT_LABELS] = { 0 };
+    u32 j = 0;
+    u32 size = 0;
+    u64 hash = 0;
+    char *id = NULL;
+    char key[NAME_MAX + 1] = "";
+    fault_entry *index = NULL;
+    fault_entry *e = NULL;
+
+    // Labels and their alignment are the same for every fault.
+    for (i = 0; fault_labels[i]; i++) {
+        common_labels[i] = get_common_var(fault_labels[i]);
+        label_len = strlen(common_labels[i]);
+        w_label_len[i] = utf8_to_wchar(common_labels[i], label_len, NULL, 0, 0);
+        if (w_label_len[i] > max_label_len) {
+            max_label_len = w_label_len[i];
+        }
+    }
+    for (i = 0; fault_labels[i]; i++) {
+        common_label_padding[i] = max_label_len - w_label_len[i] + 1;
+    }
+    common_unknown = get_common_var("unknown");
+
+    for (xmlNode * node = xmlFirstElementChild(xmlDocGetRootElement(ef_doc)); node; node = node->next) {
+        if (get_fault_id(node) != NULL)
+            nfaults++;
+    }
+    for (size = FAULT_SET_MIN_SLOTS; size < (u32) (nfaults * 2); size *= 2) ;
+
+    if ((index = EUCA_ZALLOC(size, sizeof(fault_entry))) == NULL) {
+        LOGERROR("malloc() failed while indexing %d faults\n", nfaults);
+        return 0;
+    }
+
+    nfaults = 0;
+    for (xmlNode * node = xmlFirstElementChild(xmlDocGetRootElement(ef_doc)); node; node = node->next) {
+        if ((id = get_fault_id(node)) == NULL)
+            continue;
+
+        if (!fault_id_key(id, key, sizeof(key))) {
+            LOGWARN("fault id %s is too long--not indexing it.\n", id);
+            continue;
+        }
+        // The first fault with a given id wins, as in get_eucafault().
+        hash = euca_hash64_str(key);
+        for (j = hash & (size - 1); (index[j].id != NULL) && ((index[j].hash != hash) || strcmp(index[j].id, key)); j = (j + 1) & (size - 1)) ;
+        if (index[j].id != NULL) {
+            LOGDEBUG("fault id %s is in the registry twice--keeping the first.\n", id);
+            continue;
+        }
+
+        e = &index[j];
+        if ((e->id = strdup(key)) == NULL) {
+            LOGERROR("malloc() failed while indexing fault %s\n", id);
+            continue;
+        }
+        e->hash = hash;
+        e->message = compile_fault_var(get_fault_var("fault", node));
+        for (i = 0; fault_labels[i]; i++) {
+            e->labels[i] = compile_fault_var(get_fault_var(fault_labels[i], node));
+        }
+        nfaults++;
+    }
+
+    fault_index = index;
+    fault_index_size = size;
+    LOGTRACE("Indexed %d faults in %u slots.\n", nfaults, size);
+    return nfaults;
+}
+
+//!
+//! Looks a fault up in the index of the registry.
+//!
+//! @param[in] fault_id the fault identifier string (case does not matter)
+//!
+//! @return a pointer to the precompiled fault or NULL if none found.
+//!
+static const fault_entry *find_fault_entry(const char *fault_id)
+{
+    u32 i = 0;
+    u64 hash = 0;
+    char key[NAME_MAX + 1] = "";
+
+    if ((fault_index == NULL) || (fault_id == NULL) || !fault_id_key(fault_id, key, sizeof(key)))
+        return NULL;
+
+    hash = euca_hash64_str(key);
+    for (i = hash & (fault_index_size - 1); fault_index[i].id != NULL; i = (i + 1) & (fault_index_size - 1)) {
+        if ((fault_index[i].hash == hash) && !strcmp(fault_index[i].id, key))
+            return (&fault_index[i]);
+    }
+    return NULL;
+}
+
+//!
+//! Prints a fault message to the fault log, with the variables substituted from the map.
+//!
+//! @param[in] t the compiled message
+//! @param[in] map a set of param/paramText key/value pairs, may be NULL
+//!
+static void print_fault_var(const char_template * t, const char_map ** map)
+{
+    char *fault_subbed = NULL;
+
+    if ((fault_subbed = c_varsub_render(t, map)) != NULL) {
+        fputs(fault_subbed, faultlog);
+    } else {
+        fputs(t->text, faultlog);
+    }
+    EUCA_FREE(fault_subbed);
+}
+
 //!
 //! Formats fault-log output and sends to fault log (or stdout/stderr).
 //!
@@ -853,37 +1117,18 @@ static char *get_fault_var(const char *var, const xmlNode * f_node)
 //!
 //! @return TRUE if the operation was successful otherwise FALSE is returned.
 //!
+//! @see build_fault_index()
+//!
 static boolean format_eucafault(const char *fault_id, const char_map ** map)
 {
-    static int max_label_len = 0;
-    char *fault_var = NULL;
     time_t secs;
     struct tm lt;
-    xmlNode *fault_node = get_eucafault(fault_id, NULL);
+    const fault_entry *fault = find_fault_entry(fault_id);
 
-    if (fault_node == NULL) {
+    if (fault == NULL) {
         LOGERROR("Fault %s detected, could not find fault id in registry.\n", fault_id);
         return FALSE;
     }
-    // Determine label alignment. (Only needs to be done once.)
-    if (!max_label_len) {
-        for (int i = 0; fault_labels[i]; i++) {
-            int label_len = 0;
-            int w_label_len = 0;
-
-            char *label = get_common_var(fault_labels[i]);
-            label_len = strlen(label);
-
-            w_label_len = utf8_to_wchar(label, label_len, NULL, 0, 0);
-            EUCA_FREE(label);
-            if (w_label_len > max_label_len) {
-                max_label_len = w_label_len;
-            }
-        }
-    }
-    // Top border.
-    fprintf(faultlog, "%s\n", STARS);
-
     // Get time.
     secs = time(NULL);
     if (localtime_r(&secs, &lt) == NULL) {
@@ -895,58 +1140,39 @@ static boolean format_eucafault(const char *fault_id, const char_map ** map)
         lt.tm_year += 1900;
         lt.tm_mon += 1;
     }
+
+    // Keep entries logged from several threads in one piece.
+    flockfile(faultlog);
+
+    // Top border.
+    fprintf(faultlog, "%s\n", STARS);
+
     // Construct timestamped fault header.
     fprintf(faultlog, "  ERR-%s %04d-%02d-%02d %02d:%02d:%02dZ ", fault_id, lt.tm_year, lt.tm_mon, lt.tm_mday, lt.tm_hour, lt.tm_min, lt.tm_sec);
 
-    if ((fault_var = get_fault_var("fault", fault_node)) != NULL) {
-        char *fault_subbed = NULL;
-
-        if ((fault_subbed = c_varsub(fault_var, map)) != NULL) {
-            fprintf(faultlog, "%s\n\n", fault_subbed);
-        } else {
-            fprintf(faultlog, "%s\n\n", fault_var);
-        }
-        EUCA_FREE(fault_subbed);
-        EUCA_FREE(fault_var);
+    if (fault->message != NULL) {
+        print_fault_var(fault->message, map);
+        fprintf(faultlog, "\n\n");
     } else {
-        char *common_var = get_common_var("unknown");
-        fprintf(faultlog, "%s\n\n", common_var);
-        EUCA_FREE(common_var);
+        fprintf(faultlog, "%s\n\n", common_unknown);
     }
 
     // Construct fault information lines.
     for (int i = 0; fault_labels[i]; i++) {
-        int w_common_var_len = 0;
-        int common_var_len = 0;
-        int padding = 0;
-        char *common_var = get_common_var(fault_labels[i]);
-
-        common_var_len = strlen(common_var);
-        w_common_var_len = utf8_to_wchar(common_var, common_var_len, NULL, 0, 0);
-        padding = max_label_len - w_common_var_len + 1;
-        fprintf(faultlog, "%s%*s %s: ", BARS, padding, " ", common_var);
-        EUCA_FREE(common_var);
-
-        if ((fault_var = get_fault_var(fault_labels[i], fault_node)) != NULL) {
-            char *fault_subbed = NULL;
-
-            if ((fault_subbed = c_varsub(fault_var, map)) != NULL) {
-                fprintf(faultlog, "%s", fault_subbed);
-            } else {
-                fprintf(faultlog, "%s", fault_var);
-            }
-            EUCA_FREE(fault_subbed);
-            EUCA_FREE(fault_var);
+        fprintf(faultlog, "%s%*s %s: ", BARS, common_label_padding[i], " ", common_labels[i]);
+
+        if (fault->labels[i] != NULL) {
+            print_fault_var(fault->labels[i], map);
         } else {
-            common_var = get_common_var("unknown");
-            fprintf(faultlog, "%s", common_var);
-            EUCA_FREE(common_var);
+            fprintf(faultlog, "%s", common_unknown);
         }
         fprintf(faultlog, "\n");
     }
     // Bottom border.
     fprintf(faultlog, "%s\n\n", STARS);
     fflush(faultlog);
+
+    funlockfile(faultlog);
     return TRUE;
 }
 
@@ -960,40 +1186,40 @@ static boolean format_eucafault(const char *fault_id, const char_map ** map)
 //!
 boolean is_redundant_eucafault(const char *fault_id, const char_map ** vars)
 {
+    int i = 0;
+    size_t len = 0;
+    u64 hash = 0;
+    char *new = NULL;
+    char *p = NULL;
+    boolean found = FALSE;
+
     // just concatenate everything together: fault_id+key1+val1+key2...
-    char *new = strdup(fault_id);
-    for (int i = 0; vars && vars[i] != NULL; i++) {
-        const char_map *v = vars[i];
-        new = euca_strdupcat(new, v->key);
-        new = euca_strdupcat(new, v->val);
+    len = strlen(fault_id) + 1;
+    for (i = 0; vars && vars[i] != NULL; i++) {
+        len += strlen(vars[i]->key) + strlen(vars[i]->val);
     }
+    if ((new = EUCA_ALLOC(len, sizeof(char))) == NULL)
+        return FALSE;
 
-    //! see if it is already in our linked list (@TODO switch to a more efficient data structure)
-    for (struct suppress_list * s = redundant; s != NULL; s = s->next) {
-        char *old = s->id;
-
-        // compare strings ourselves (instead of strcmp) so we can bail early
-        int i;
-        for (i = 0; new[i] != '\0' && old[i] != '\0'; i++)
-            if (new[i] != old[i])
-                break;                 // not the same string
-
-        if (new[i] == '\0' && old[i] == '\0') { // found the match in the LL
-            EUCA_FREE(new);
-            return TRUE;
-        }
+    p = stpcpy(new, fault_id);
+    for (i = 0; vars && vars[i] != NULL; i++) {
+        p = stpcpy(p, vars[i]->key);
+        p = stpcpy(p, vars[i]->val);
     }
+    hash = euca_hash64_str(new);
 
-    // was not found, so add it to the list
-    struct suppress_list *s = EUCA_ZALLOC(1, sizeof(struct suppress_list));
-    s->id = new;
-    if (redundant == NULL) {
-        redundant = s;
-    } else {
-        redundant->next = s;
+    pthread_mutex_lock(&fault_mutex);
+    {
+        if ((found = fault_set_contains(&redundant, new, hash)) == FALSE) {
+            // was not found, so remember it
+            if (fault_set_add(&redundant, new, hash))
+                new = NULL;
+        }
     }
+    pthread_mutex_unlock(&fault_mutex);
 
-    return FALSE;
+    EUCA_FREE(new);
+    return (found);
 }
 
 //!
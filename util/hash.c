@@ -228,13 +228,35 @@ int hash_b64enc_string(const char *in, char **out)
 //!       readable hex values.
 //!
 int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
+{
+    // Make sure our parameters are valid
+    if (!sBuf || !sValue)
+        return (EUCA_INVALID_ERROR);
+
+    return (mem2md5str(sBuf, bufSize, sValue, strlen(sValue)));
+}
+
+//!
+//! Calculates the md5 hash of the 'len' bytes at 'pValue' and places it into 'sBuf' in human
+//! readable hex values, like str2md5str() does for a string
+//!
+//! @param[in,out] sBuf    the string buffer that contains the result
+//! @param[in]     bufSize the size of our output string buffer
+//! @param[in]     pValue  the bytes to compute MD5 hash from
+//! @param[in]     len     the number of bytes at pValue
+//!
+//! @return the same as str2md5str()
+//!
+//! @see str2md5str()
+//!
+int mem2md5str(char *sBuf, u32 bufSize, const void *pValue, size_t len)
 {
     u32 i = 0;
     char *pBuf = NULL;
     u8 md5digest[MD5_DIGEST_LENGTH + 1] = { 0 };    // +1 for NULL termination.
 
     // Make sure our parameters are valid
-    if (!sBuf || !sValue)
+    if (!sBuf || !pValue)
         return (EUCA_INVALID_ERROR);
 
     // Make sure we have enough space to write the hash in the given buffer
@@ -245,7 +267,7 @@ int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
     bzero(md5digest, sizeof(md5digest));
 
     // Compute the MD5 hash
-    if (MD5(((const u8 *)sValue), strlen(sValue), md5digest) == NULL)
+    if (MD5(((const u8 *)pValue), len, md5digest) == NULL)
         return (EUCA_ERROR);
 
     // zero out the buffer
@@ -68,7 +68,8 @@
 
 //!
 //! @file util/hash.h
-//! Provides various MD5 and Jenkins hash functionality
+//! Provides various MD5 and Jenkins hash functionality, and a fast non-cryptographic hash
+//! for hash tables
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -77,12 +78,18 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#include <string.h>                    // memcpy
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define HASH64_P0                      0xa0761d6478bd642fULL    //!< mixing constants of euca_hash64()
+#define HASH64_P1                      0xe7037ed1a0b428dbULL
+#define HASH64_P2                      0x8ebc6af09c88c6e3ULL
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -116,6 +123,7 @@
 int hash_b64enc_string(const char *in, char **out);
 
 int str2md5str(char *sBuf, u32 bufSize, const char *sValue);
+int mem2md5str(char *sBuf, u32 bufSize, const void *pValue, size_t len);
 
 char *file2md5str(const char *path);
 
@@ -128,6 +136,11 @@ int hexjenkins(char *sBuf, u32 bufSize, const char *sValue);
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static inline u64 hash64_mix(u64 a, u64 b) __attribute__ ((always_inline));
+static inline u64 hash64_read(const u8 * p, size_t len) __attribute__ ((always_inline));
+static inline u64 euca_hash64(const void *key, size_t len, u64 seed);
+static inline u64 euca_hash64_str(const char *key);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -140,4 +153,78 @@ int hexjenkins(char *sBuf, u32 bufSize, const char *sValue);
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//!
+//! Multiplies two 64-bit values into 128 bits and folds the halves together
+//!
+//! @param[in] a
+//! @param[in] b
+//!
+//! @return the folded product
+//!
+static inline u64 hash64_mix(u64 a, u64 b)
+{
+    __uint128_t r = ((__uint128_t) a) * b;
+    return ((u64) r ^ (u64) (r >> 64));
+}
+
+//!
+//! Reads up to 8 bytes, in host order, without alignment requirements
+//!
+//! @param[in] p
+//! @param[in] len how many bytes to read, at most 8
+//!
+//! @return the bytes, zero-extended
+//!
+static inline u64 hash64_read(const u8 * p, size_t len)
+{
+    u64 v = 0;
+    memcpy(&v, p, len);
+    return (v);
+}
+
+//!
+//! Fast 64-bit non-cryptographic hash, built like wyhash around a 64x64->128 bit multiply
+//! that mixes 16 bytes of input per step. Several times faster than jenkins() on keys of
+//! more than a few bytes, with good enough dispersion for open addressing. Not suited where
+//! an attacker chooses the keys and the seed is known, nor for anything persistent, since
+//! the result depends on the byte order of the host.
+//!
+//! @param[in] key the data to hash
+//! @param[in] len the length of the data
+//! @param[in] seed varies the hash function
+//!
+//! @return the hash of the data
+//!
+static inline u64 euca_hash64(const void *key, size_t len, u64 seed)
+{
+    size_t left = len;
+    const u8 *p = key;
+    u64 a = 0;
+    u64 b = 0;
+    u64 h = seed ^ HASH64_P0;
+
+    for (; left > 16; left -= 16, p += 16) {
+        h = hash64_mix(hash64_read(p, 8) ^ HASH64_P1, hash64_read(p + 8, 8) ^ h);
+    }
+    if (left > 8) {
+        a = hash64_read(p, 8);
+        b = hash64_read(p + 8, left - 8);
+    } else {
+        a = hash64_read(p, left);
+    }
+    return (hash64_mix(HASH64_P1 ^ len, hash64_mix(a ^ HASH64_P1, b ^ h ^ HASH64_P2)));
+}
+
+//!
+//! euca_hash64() of a NUL-terminated string, with the default seed
+//!
+//! @param[in] key
+//!
+//! @return the hash of the string
+//!
+static inline u64 euca_hash64_str(const char *key)
+{
+    return (euca_hash64(key, strlen(key), 0));
+}
+
 #endif /* ! _INCLUDE_HASH_H_ */
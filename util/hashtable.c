@@ -0,0 +1,664 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/hashtable.c
+//! Implements the hash tables of hashtable.h. Both flavors probe linearly from the slot the
+//! hash of a key points to, and keep at least a quarter of their slots free so probes stay
+//! short. Removal shifts the following entries of a probe sequence back instead of leaving
+//! tombstones, so that tables that see much churn do not slow down.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _UNIT_TEST
+#include <assert.h>
+#endif /* _UNIT_TEST */
+
+#include "eucalyptus.h"
+#include "misc.h"
+#include "euca_string.h"
+#include "hash.h"
+#include "hashtable.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define FIXED_SLOT_USED                   (1ULL << 63)  //!< set in the stored hash of a fixed_hashtable slot that holds a key
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static u32 slots_for(u32 capacity);
+static int hashtable_find(const hashtable * t, const char *key, u64 hash, u32 * pos);
+static int hashtable_grow(hashtable * t);
+static u64 *fixed_slot(const fixed_hashtable * t, u32 i);
+static int fixed_hashtable_find(const fixed_hashtable * t, const char *key, u64 hash, u32 * pos);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Whether a slot at distance from i to j of its home slot h, going around, can be moved back to i
+#define CAN_SHIFT(_i, _j, _h)             (((_i) <= (_j)) ? (((_h) <= (_i)) || ((_h) > (_j))) : (((_h) <= (_i)) && ((_h) > (_j))))
+
+//! Key of a fixed_hashtable slot
+#define FIXED_KEY(_slot)                  ((char *)((_slot) + 1))
+
+//! Value of a fixed_hashtable slot
+#define FIXED_VAL(_t, _slot)              ((void *)(FIXED_KEY(_slot) + (_t)->key_size))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Computes how many slots hold a number of keys with a quarter of the slots free
+//!
+//! @param[in] capacity the number of keys
+//!
+//! @return a power of 2, or 0 if it would not fit in 32 bits
+//!
+static u32 slots_for(u32 capacity)
+{
+    u64 size = HASHTABLE_MIN_SLOTS;
+
+    while ((size - (size / 4)) < capacity)
+        size *= 2;
+    return ((size > 0x80000000ULL) ? 0 : (u32) size);
+}
+
+//!
+//! Looks for a key, or for the free slot where it would go
+//!
+//! @param[in]  t the table
+//! @param[in]  key the key
+//! @param[in]  hash its hash
+//! @param[out] pos set to the slot of the key, or to the free slot that ends its probe sequence
+//!
+//! @return TRUE if the key was found or FALSE otherwise
+//!
+static int hashtable_find(const hashtable * t, const char *key, u64 hash, u32 * pos)
+{
+    u32 mask = t->size - 1;
+    u32 i = (u32) hash & mask;
+
+    for (; t->slots[i].key; i = (i + 1) & mask) {
+        if ((t->slots[i].hash == hash) && !strcmp(t->slots[i].key, key)) {
+            *pos = i;
+            return (TRUE);
+        }
+    }
+    *pos = i;
+    return (FALSE);
+}
+
+//!
+//! Doubles the number of slots of a table
+//!
+//! @param[in] t the table
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR on failure
+//!
+static int hashtable_grow(hashtable * t)
+{
+    u32 i = 0;
+    u32 j = 0;
+    u32 size = t->size * 2;
+    hashtable_slot *slots = NULL;
+    hashtable_slot *old = t->slots;
+
+    if ((size == 0) || ((slots = EUCA_ZALLOC(size, sizeof(hashtable_slot))) == NULL))
+        return (EUCA_MEMORY_ERROR);
+
+    for (i = 0; i < t->size; i++) {
+        if (old[i].key == NULL)
+            continue;
+        for (j = (u32) old[i].hash & (size - 1); slots[j].key; j = (j + 1) & (size - 1)) ;
+        slots[j] = old[i];
+    }
+
+    t->slots = slots;
+    t->size = size;
+    EUCA_FREE(old);
+    return (EUCA_OK);
+}
+
+//!
+//! Creates a table
+//!
+//! @param[in] capacity how many keys to make room for; the table grows beyond as needed
+//!
+//! @return the table, which the caller must free with hashtable_free(), or NULL on failure
+//!
+hashtable *hashtable_create(u32 capacity)
+{
+    hashtable *t = NULL;
+
+    if ((t = EUCA_ZALLOC(1, sizeof(hashtable))) == NULL)
+        return (NULL);
+
+    if (((t->size = slots_for(capacity)) == 0) || ((t->slots = EUCA_ZALLOC(t->size, sizeof(hashtable_slot))) == NULL)) {
+        EUCA_FREE(t);
+        return (NULL);
+    }
+    return (t);
+}
+
+//!
+//! Frees a table and its copies of the keys. The values are left to the caller.
+//!
+//! @param[in] t the table, may be NULL
+//!
+void hashtable_free(hashtable * t)
+{
+    if (t == NULL)
+        return;
+
+    for (u32 i = 0; i < t->size; i++) {
+        EUCA_FREE(t->slots[i].key);
+    }
+    EUCA_FREE(t->slots);
+    EUCA_FREE(t);
+}
+
+//!
+//! Sets the value of a key, adding the key if needed
+//!
+//! @param[in] t the table
+//! @param[in] key the key, which the table copies
+//! @param[in] val the value, which stays the caller's
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if an argument is NULL or EUCA_MEMORY_ERROR
+//!         if the table cannot grow
+//!
+int hashtable_set(hashtable * t, const char *key, void *val)
+{
+    u32 pos = 0;
+    u64 hash = 0;
+
+    if ((t == NULL) || (key == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    hash = euca_hash64_str(key);
+    if (hashtable_find(t, key, hash, &pos)) {
+        t->slots[pos].val = val;
+        return (EUCA_OK);
+    }
+
+    if ((t->count + 1) > (t->size - (t->size / 4))) {
+        if (hashtable_grow(t) != EUCA_OK)
+            return (EUCA_MEMORY_ERROR);
+        hashtable_find(t, key, hash, &pos);
+    }
+
+    if ((t->slots[pos].key = strdup(key)) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    t->slots[pos].val = val;
+    t->slots[pos].hash = hash;
+    t->count++;
+    return (EUCA_OK);
+}
+
+//!
+//! Gets the value of a key
+//!
+//! @param[in] t the table
+//! @param[in] key the key
+//!
+//! @return the value, or NULL if the key is not in the table
+//!
+void *hashtable_get(const hashtable * t, const char *key)
+{
+    u32 pos = 0;
+
+    if ((t == NULL) || (key == NULL) || !hashtable_find(t, key, euca_hash64_str(key), &pos))
+        return (NULL);
+    return (t->slots[pos].val);
+}
+
+//!
+//! Removes a key from a table
+//!
+//! @param[in] t the table
+//! @param[in] key the key
+//!
+//! @return the value the key had, or NULL if it was not in the table
+//!
+void *hashtable_remove(hashtable * t, const char *key)
+{
+    u32 i = 0;
+    u32 j = 0;
+    u32 mask = 0;
+    void *val = NULL;
+
+    if ((t == NULL) || (key == NULL) || !hashtable_find(t, key, euca_hash64_str(key), &i))
+        return (NULL);
+
+    mask = t->size - 1;
+    val = t->slots[i].val;
+    EUCA_FREE(t->slots[i].key);
+    t->count--;
+
+    // move back the entries that this one was in the way of
+    for (j = (i + 1) & mask; t->slots[j].key; j = (j + 1) & mask) {
+        if (CAN_SHIFT(i, j, ((u32) t->slots[j].hash & mask))) {
+            t->slots[i] = t->slots[j];
+            t->slots[j].key = NULL;
+            i = j;
+        }
+    }
+    return (val);
+}
+
+//!
+//! Iterates over the keys of a table, in no particular order. The table must not have keys
+//! added or removed during the iteration.
+//!
+//! @param[in]     t the table
+//! @param[in,out] pos where the iteration is, to be set to 0 before the first call
+//! @param[out]    pKey if not NULL, set to the next key
+//! @param[out]    pVal if not NULL, set to its value
+//!
+//! @return TRUE if a key was returned or FALSE at the end of the table
+//!
+int hashtable_next(const hashtable * t, u32 * pos, const char **pKey, void **pVal)
+{
+    if ((t == NULL) || (pos == NULL))
+        return (FALSE);
+
+    for (; *pos < t->size; (*pos)++) {
+        if (t->slots[*pos].key) {
+            if (pKey)
+                (*pKey) = t->slots[*pos].key;
+            if (pVal)
+                (*pVal) = t->slots[*pos].val;
+            (*pos)++;
+            return (TRUE);
+        }
+    }
+    return (FALSE);
+}
+
+//!
+//! Gets the slot i of a fixed table, made of the stored hash, then the key, then the value
+//!
+//! @param[in] t the table
+//! @param[in] i the slot
+//!
+//! @return a pointer to the stored hash of the slot
+//!
+static u64 *fixed_slot(const fixed_hashtable * t, u32 i)
+{
+    return ((u64 *) (((char *)(t + 1)) + ((size_t)i * t->slot_size)));
+}
+
+//!
+//! Looks for a key in a fixed table, or for the free slot where it would go
+//!
+//! @param[in]  t the table
+//! @param[in]  key the key
+//! @param[in]  hash its hash, with FIXED_SLOT_USED set
+//! @param[out] pos set to the slot of the key, or to the free slot that ends its probe sequence
+//!
+//! @return TRUE if the key was found or FALSE otherwise
+//!
+static int fixed_hashtable_find(const fixed_hashtable * t, const char *key, u64 hash, u32 * pos)
+{
+    u32 mask = t->size - 1;
+    u32 i = (u32) hash & mask;
+    u64 *slot = NULL;
+
+    for (slot = fixed_slot(t, i); *slot; i = (i + 1) & mask, slot = fixed_slot(t, i)) {
+        if ((*slot == hash) && !strcmp(FIXED_KEY(slot), key)) {
+            *pos = i;
+            return (TRUE);
+        }
+    }
+    *pos = i;
+    return (FALSE);
+}
+
+//!
+//! Computes how much memory a fixed table needs
+//!
+//! @param[in] capacity how many keys it must take
+//! @param[in] key_size bytes for each key, including its NUL
+//! @param[in] val_size bytes for each value
+//!
+//! @return the size in bytes or 0 if the table would be too large
+//!
+size_t fixed_hashtable_size(u32 capacity, u32 key_size, u32 val_size)
+{
+    u32 size = slots_for(capacity);
+    size_t slot_size = (sizeof(u64) + key_size + val_size + 7) & ~((size_t)7);
+
+    if ((size == 0) || (key_size == 0) || (slot_size > 0xFFFFFFFFULL))
+        return (0);
+    return (sizeof(fixed_hashtable) + ((size_t)size * slot_size));
+}
+
+//!
+//! Sets up an empty fixed table in memory from the caller
+//!
+//! @param[in] mem memory of at least fixed_hashtable_size() bytes, aligned for a u64
+//! @param[in] len the size of mem
+//! @param[in] capacity how many keys the table must take
+//! @param[in] key_size bytes for each key, including its NUL
+//! @param[in] val_size bytes for each value
+//!
+//! @return the table, at the start of mem, or NULL if len is too small
+//!
+fixed_hashtable *fixed_hashtable_init(void *mem, size_t len, u32 capacity, u32 key_size, u32 val_size)
+{
+    size_t needed = fixed_hashtable_size(capacity, key_size, val_size);
+    fixed_hashtable *t = mem;
+
+    if ((mem == NULL) || (needed == 0) || (len < needed))
+        return (NULL);
+
+    memset(mem, 0, needed);
+    t->size = slots_for(capacity);
+    t->key_size = key_size;
+    t->val_size = val_size;
+    t->slot_size = (sizeof(u64) + key_size + val_size + 7) & ~((size_t)7);
+    t->capacity = t->size - (t->size / 4);
+    return (t);
+}
+
+//!
+//! Gets the value of a key in a fixed table
+//!
+//! @param[in] t the table
+//! @param[in] key the key
+//!
+//! @return a pointer to the value, inside the table, or NULL if the key is not in the table
+//!
+void *fixed_hashtable_get(const fixed_hashtable * t, const char *key)
+{
+    u32 pos = 0;
+
+    if ((t == NULL) || (key == NULL) || !fixed_hashtable_find(t, key, (euca_hash64_str(key) | FIXED_SLOT_USED), &pos))
+        return (NULL);
+    return (FIXED_VAL(t, fixed_slot(t, pos)));
+}
+
+//!
+//! Adds a key to a fixed table, if it is not there already, and returns where its value is
+//!
+//! @param[in] t the table
+//! @param[in] key the key, which must be shorter than the key size of the table
+//!
+//! @return a pointer to the value, inside the table, which is zeroed for a new key, or NULL
+//!         if the key is too long or the table is full
+//!
+void *fixed_hashtable_put(fixed_hashtable * t, const char *key)
+{
+    u32 pos = 0;
+    u64 hash = 0;
+    u64 *slot = NULL;
+
+    if ((t == NULL) || (key == NULL) || (strlen(key) >= t->key_size))
+        return (NULL);
+
+    hash = euca_hash64_str(key) | FIXED_SLOT_USED;
+    if (fixed_hashtable_find(t, key, hash, &pos))
+        return (FIXED_VAL(t, fixed_slot(t, pos)));
+    if (t->count >= t->capacity)
+        return (NULL);
+
+    slot = fixed_slot(t, pos);
+    memset(slot, 0, t->slot_size);
+    euca_strncpy(FIXED_KEY(slot), key, t->key_size);
+    *slot = hash;
+    t->count++;
+    return (FIXED_VAL(t, slot));
+}
+
+//!
+//! Removes a key from a fixed table
+//!
+//! @param[in] t the table
+//! @param[in] key the key
+//!
+//! @return EUCA_OK on success or EUCA_NOT_FOUND_ERROR if the key is not in the table
+//!
+int fixed_hashtable_remove(fixed_hashtable * t, const char *key)
+{
+    u32 i = 0;
+    u32 j = 0;
+    u32 mask = 0;
+    u64 *slot = NULL;
+
+    if ((t == NULL) || (key == NULL) || !fixed_hashtable_find(t, key, (euca_hash64_str(key) | FIXED_SLOT_USED), &i))
+        return (EUCA_NOT_FOUND_ERROR);
+
+    mask = t->size - 1;
+    t->count--;
+    for (j = (i + 1) & mask; *(slot = fixed_slot(t, j)); j = (j + 1) & mask) {
+        if (CAN_SHIFT(i, j, ((u32) (*slot) & mask))) {
+            memcpy(fixed_slot(t, i), slot, t->slot_size);
+            i = j;
+        }
+    }
+    *fixed_slot(t, i) = 0;
+    return (EUCA_OK);
+}
+
+//!
+//! Iterates over the keys of a fixed table, in no particular order. The table must not have
+//! keys added or removed during the iteration.
+//!
+//! @param[in]     t the table
+//! @param[in,out] pos where the iteration is, to be set to 0 before the first call
+//! @param[out]    pKey if not NULL, set to the next key
+//! @param[out]    pVal if not NULL, set to a pointer to its value
+//!
+//! @return TRUE if a key was returned or FALSE at the end of the table
+//!
+int fixed_hashtable_next(const fixed_hashtable * t, u32 * pos, const char **pKey, void **pVal)
+{
+    u64 *slot = NULL;
+
+    if ((t == NULL) || (pos == NULL))
+        return (FALSE);
+
+    for (; *pos < t->size; (*pos)++) {
+        if (*(slot = fixed_slot(t, *pos))) {
+            if (pKey)
+                (*pKey) = FIXED_KEY(slot);
+            if (pVal)
+                (*pVal) = FIXED_VAL(t, slot);
+            (*pos)++;
+            return (TRUE);
+        }
+    }
+    return (FALSE);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int main(int argc, char *argv[])
+{
+    u32 i = 0;
+    u32 pos = 0;
+    int n = 0;
+    char key[32] = "";
+    char *mem = NULL;
+    const char *k = NULL;
+    void *v = NULL;
+    size_t len = 0;
+    hashtable *t = NULL;
+    fixed_hashtable *f = NULL;
+
+    assert((t = hashtable_create(0)) != NULL);
+    assert(hashtable_get(t, "foo") == NULL);
+    for (i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "key-%u", i);
+        assert(hashtable_set(t, key, (void *)((long)i + 1)) == EUCA_OK);
+    }
+    assert(t->count == 10000);
+    assert(hashtable_set(t, "key-5", (void *)7L) == EUCA_OK);
+    assert(hashtable_get(t, "key-5") == (void *)7L);
+    for (i = 0; i < 10000; i += 2) {
+        snprintf(key, sizeof(key), "key-%u", i);
+        assert(hashtable_remove(t, key) != NULL);
+    }
+    for (i = 1; i < 10000; i += 2) {
+        snprintf(key, sizeof(key), "key-%u", i);
+        assert(hashtable_get(t, key) == ((i == 5) ? (void *)7L : (void *)((long)i + 1)));
+    }
+    for (pos = 0, n = 0; hashtable_next(t, &pos, &k, &v); n++) ;
+    assert(n == 5000);
+    hashtable_free(t);
+
+    len = fixed_hashtable_size(100, 16, sizeof(int));
+    assert((mem = EUCA_ZALLOC(1, len)) != NULL);
+    assert(fixed_hashtable_init(mem, (len - 1), 100, 16, sizeof(int)) == NULL);
+    assert((f = fixed_hashtable_init(mem, len, 100, 16, sizeof(int))) != NULL);
+    assert(fixed_hashtable_put(f, "a key that is too long") == NULL);
+    for (i = 0; i < f->capacity; i++) {
+        snprintf(key, sizeof(key), "i-%u", i);
+        *((int *)fixed_hashtable_put(f, key)) = i;
+    }
+    assert(fixed_hashtable_put(f, "one too many") == NULL);
+    assert(fixed_hashtable_remove(f, "i-3") == EUCA_OK);
+    assert(fixed_hashtable_remove(f, "i-3") == EUCA_NOT_FOUND_ERROR);
+    assert(fixed_hashtable_get(f, "i-3") == NULL);
+    for (i = 0; i < f->capacity; i++) {
+        snprintf(key, sizeof(key), "i-%u", i);
+        assert((i == 3) || (*((int *)fixed_hashtable_get(f, key)) == (int)i));
+    }
+    for (pos = 0, n = 0; fixed_hashtable_next(f, &pos, &k, &v); n++) ;
+    assert(n == (int)(f->capacity - 1));
+    EUCA_FREE(mem);
+
+    printf("all tests passed\n");
+    return (EUCA_OK);
+}
+#endif /* _UNIT_TEST */
@@ -0,0 +1,189 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_HASHTABLE_H_
+#define _INCLUDE_HASHTABLE_H_
+
+//!
+//! @file util/hashtable.h
+//! Hash tables with string keys, using open addressing with linear probing over
+//! euca_hash64(). Two flavors:
+//!
+//! \li hashtable, which grows as needed, copies its keys and stores pointers to values that
+//!     the caller owns;
+//! \li fixed_hashtable, of a capacity set once, which stores keys and values of fixed sizes
+//!     inline and holds no pointers, so it can live in any memory the caller provides,
+//!     such as a shared memory segment, and be used from several processes.
+//!
+//! Neither does any locking.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define HASHTABLE_MIN_SLOTS                       16    //!< smallest number of slots in a table
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A slot of a hashtable
+typedef struct hashtable_slot_t {
+    char *key;                         //!< copy of the key, or NULL if the slot is free
+    void *val;                         //!< the value
+    u64 hash;                          //!< hash of the key
+} hashtable_slot;
+
+//! A growable hash table of string keys to pointers
+typedef struct hashtable_t {
+    u32 size;                          //!< number of slots, a power of 2
+    u32 count;                         //!< number of keys in the table
+    hashtable_slot *slots;             //!< the slots
+} hashtable;
+
+//! Header of a fixed_hashtable; the slots follow it in the same memory
+typedef struct fixed_hashtable_t {
+    u32 size;                          //!< number of slots, a power of 2
+    u32 count;                         //!< number of keys in the table
+    u32 key_size;                      //!< bytes reserved for each key, including its NUL
+    u32 val_size;                      //!< bytes reserved for each value
+    u32 slot_size;                     //!< bytes of each slot: hash, key and value, aligned
+    u32 capacity;                      //!< how many keys the table takes
+} fixed_hashtable;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! @{
+//! @name growable tables
+hashtable *hashtable_create(u32 capacity);
+void hashtable_free(hashtable * t);
+int hashtable_set(hashtable * t, const char *key, void *val);
+void *hashtable_get(const hashtable * t, const char *key);
+void *hashtable_remove(hashtable * t, const char *key);
+int hashtable_next(const hashtable * t, u32 * pos, const char **pKey, void **pVal);
+//! @}
+
+//! @{
+//! @name fixed-capacity tables, in caller-provided memory
+size_t fixed_hashtable_size(u32 capacity, u32 key_size, u32 val_size);
+fixed_hashtable *fixed_hashtable_init(void *mem, size_t len, u32 capacity, u32 key_size, u32 val_size);
+void *fixed_hashtable_get(const fixed_hashtable * t, const char *key);
+void *fixed_hashtable_put(fixed_hashtable * t, const char *key);
+int fixed_hashtable_remove(fixed_hashtable * t, const char *key);
+int fixed_hashtable_next(const fixed_hashtable * t, u32 * pos, const char **pKey, void **pVal);
+//! @}
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_HASHTABLE_H_ */
@@ -0,0 +1,1135 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+
+//!
+//! @file util/instance_checkpoint.c
+//! Compact binary checkpoint of the instance struct, see instance_checkpoint.h
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "eucalyptus.h"
+#include "misc.h"
+#include "log.h"
+#include "euca_file.h"
+#include "data.h"
+#include "instance_checkpoint.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! @{
+//! @name Tag ranges of the records, the low byte numbers the field within the range
+#define TAG_INSTANCE                             0x0000 //!< fields of ncInstance, index is 0
+#define TAG_GROUP_NAME                           0x0100 //!< groupNames[index]
+#define TAG_VBR                                  0x0200 //!< fields of params.virtualBootRecord[index]
+#define TAG_VOLUME                               0x0300 //!< fields of volumes[index]
+//! @}
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! How a field is stored
+typedef enum ckpt_kind_t {
+    CKPT_STR,                          //!< char array, stored without the NUL and the padding
+    CKPT_INT,                          //!< integer, enum or boolean of 1 to 8 bytes, stored as a 64-bit integer
+    CKPT_DBL,                          //!< double, stored as its 64-bit IEEE pattern
+} ckpt_kind;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A field of the schema. Tags are forever: a field that goes away leaves its tag unused.
+typedef struct ckpt_field_t {
+    u16 tag;                           //!< tag of the records of the field
+    ckpt_kind kind;                    //!< how the field is stored
+    size_t offset;                     //!< offset of the field in its struct
+    size_t size;                       //!< size of the field in its struct
+} ckpt_field;
+
+//! Output of the encoder, which only counts bytes when buf is NULL
+typedef struct ckpt_writer_t {
+    char *buf;                         //!< where records go, or NULL
+    size_t len;                        //!< bytes written, or counted, past the header
+    u32 records;                       //!< number of records written, or counted
+} ckpt_writer;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define FIELD(_type, _tag, _kind, _member)       { (_tag), (_kind), offsetof(_type, _member), sizeof(((_type *) 0)->_member) }
+#define INST(_tag, _kind, _member)               FIELD(ncInstance, (TAG_INSTANCE | (_tag)), _kind, _member)
+#define VBR(_tag, _kind, _member)                FIELD(virtualBootRecord, (TAG_VBR | (_tag)), _kind, _member)
+#define VOL(_tag, _kind, _member)                FIELD(ncVolume, (TAG_VOLUME | (_tag)), _kind, _member)
+
+//! Fields of ncInstance; the VBR pointers of params, tcb and generation are runtime state and not kept
+static const ckpt_field instance_fields[] = {
+    INST(1, CKPT_STR, uuid),
+    INST(2, CKPT_STR, instanceId),
+    INST(3, CKPT_STR, reservationId),
+    INST(4, CKPT_STR, userId),
+    INST(5, CKPT_STR, ownerId),
+    INST(6, CKPT_STR, accountId),
+    INST(7, CKPT_STR, imageId),
+    INST(8, CKPT_STR, kernelId),
+    INST(9, CKPT_STR, ramdiskId),
+    INST(10, CKPT_INT, retries),
+    INST(11, CKPT_STR, stateName),
+    INST(12, CKPT_STR, bundleTaskStateName),
+    INST(13, CKPT_DBL, bundleTaskProgress),
+    INST(14, CKPT_STR, createImageTaskStateName),
+    INST(15, CKPT_INT, stateCode),
+    INST(16, CKPT_INT, state),
+    INST(17, CKPT_INT, bundleTaskState),
+    INST(18, CKPT_INT, bundleBucketExists),
+    INST(19, CKPT_INT, bundleCanceled),
+    INST(20, CKPT_INT, createImageTaskState),
+    INST(21, CKPT_INT, createImagePid),
+    INST(22, CKPT_INT, createImageCanceled),
+    INST(23, CKPT_INT, migration_state),
+    INST(24, CKPT_STR, migration_src),
+    INST(25, CKPT_STR, migration_dst),
+    INST(26, CKPT_STR, migration_credentials),
+    INST(27, CKPT_STR, keyName),
+    INST(28, CKPT_STR, privateDnsName),
+    INST(29, CKPT_STR, dnsName),
+    INST(30, CKPT_INT, launchTime),
+    INST(31, CKPT_INT, expiryTime),
+    INST(32, CKPT_INT, bootTime),
+    INST(33, CKPT_INT, bundlingTime),
+    INST(34, CKPT_INT, createImageTime),
+    INST(35, CKPT_INT, terminationRequestedTime),
+    INST(36, CKPT_INT, terminationTime),
+    INST(37, CKPT_INT, migrationTime),
+    INST(38, CKPT_INT, params.mem),
+    INST(39, CKPT_INT, params.cores),
+    INST(40, CKPT_INT, params.disk),
+    INST(41, CKPT_STR, params.name),
+    INST(42, CKPT_INT, params.virtualBootRecordLen),
+    INST(43, CKPT_INT, params.nicType),
+    INST(44, CKPT_STR, params.guestNicDeviceName),
+    INST(45, CKPT_INT, ncnet.vlan),
+    INST(46, CKPT_INT, ncnet.networkIndex),
+    INST(47, CKPT_STR, ncnet.privateMac),
+    INST(48, CKPT_STR, ncnet.publicIp),
+    INST(49, CKPT_STR, ncnet.privateIp),
+    INST(50, CKPT_STR, instancePath),
+    INST(51, CKPT_STR, xmlFilePath),
+    INST(52, CKPT_STR, libvirtFilePath),
+    INST(53, CKPT_STR, consoleFilePath),
+    INST(54, CKPT_STR, floppyFilePath),
+    INST(55, CKPT_STR, hypervisorType),
+    INST(56, CKPT_INT, hypervisorCapability),
+    INST(57, CKPT_INT, hypervisorBitness),
+    INST(58, CKPT_INT, combinePartitions),
+    INST(59, CKPT_INT, do_inject_key),
+    INST(60, CKPT_STR, userData),
+    INST(61, CKPT_STR, launchIndex),
+    INST(62, CKPT_STR, platform),
+    INST(63, CKPT_INT, groupNamesSize),
+    INST(64, CKPT_INT, blkbytes),
+    INST(65, CKPT_INT, netbytes),
+    INST(66, CKPT_INT, last_stat),
+    INST(67, CKPT_STR, guestStateName),
+    INST(68, CKPT_INT, stop_requested),
+    INST(69, CKPT_STR, credential),
+    INST(70, CKPT_INT, bail_flag),
+    INST(71, CKPT_STR, rootDirective),
+    INST(72, CKPT_INT, migrationProgress),
+    INST(73, CKPT_INT, migrationRemainingBytes),
+    INST(74, CKPT_INT, migrationDirtyRate),
+    INST(75, CKPT_INT, migrationPostCopy),
+    INST(76, CKPT_INT, numaPinned),
+    INST(77, CKPT_INT, numaNode),
+    INST(78, CKPT_STR, numaCpus),
+    INST(79, CKPT_INT, hugePagesKB),
+};
+
+//! Fields of each of the first params.virtualBootRecordLen entries of params.virtualBootRecord
+static const ckpt_field vbr_fields[] = {
+    VBR(1, CKPT_STR, resourceLocation),
+    VBR(2, CKPT_STR, guestDeviceName),
+    VBR(3, CKPT_INT, sizeBytes),
+    VBR(4, CKPT_STR, formatName),
+    VBR(5, CKPT_STR, id),
+    VBR(6, CKPT_STR, typeName),
+    VBR(7, CKPT_INT, type),
+    VBR(8, CKPT_INT, locationType),
+    VBR(9, CKPT_INT, format),
+    VBR(10, CKPT_INT, diskNumber),
+    VBR(11, CKPT_INT, partitionNumber),
+    VBR(12, CKPT_INT, guestDeviceType),
+    VBR(13, CKPT_INT, guestDeviceBus),
+    VBR(14, CKPT_INT, backingType),
+    VBR(15, CKPT_STR, backingPath),
+    VBR(16, CKPT_STR, preparedResourceLocation),
+    VBR(17, CKPT_STR, guestDeviceSerialId),
+    VBR(18, CKPT_STR, backingFormat),
+};
+
+//! Fields of each entry of volumes with a volume ID
+static const ckpt_field volume_fields[] = {
+    VOL(1, CKPT_STR, volumeId),
+    VOL(2, CKPT_STR, attachmentToken),
+    VOL(3, CKPT_STR, devName),
+    VOL(4, CKPT_STR, stateName),
+    VOL(5, CKPT_STR, connectionString),
+    VOL(6, CKPT_STR, volLibvirtXml),
+};
+
+#undef FIELD
+#undef INST
+#undef VBR
+#undef VOL
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static u32 ckpt_crc32(const char *buf, size_t len);
+static void put_le(char *buf, unsigned long long val, int bytes);
+static unsigned long long get_le(const char *buf, int bytes);
+static void put_record(ckpt_writer * w, u16 tag, u16 index, const char *data, size_t len);
+static void put_field(ckpt_writer * w, const ckpt_field * field, u16 index, const char *base);
+static void put_fields(ckpt_writer * w, const ckpt_field * fields, int max_fields, u16 index, const char *base);
+static void encode_records(ckpt_writer * w, const ncInstance * instance);
+static const ckpt_field *find_field(const ckpt_field * fields, int max_fields, u16 tag);
+static const ckpt_field *find_field_at(const ckpt_field * fields, int max_fields, size_t offset);
+static void get_field(const ckpt_field * field, const char *data, size_t len, char *base);
+static int decode_records(const char *p, const char *end, u32 records, ncInstance * instance);
+static int get_compact_field(const ncInstanceCompact * compact, const ckpt_field * field, u16 index, void *buf, size_t size);
+
+#ifdef _UNIT_TEST
+int main(int argc, char **argv);
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define NELEMS(_a)                               ((int) (sizeof(_a) / sizeof((_a)[0])))
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Computes the CRC-32 (IEEE) of a buffer
+//!
+//! @param[in] buf the buffer
+//! @param[in] len its length
+//!
+//! @return the CRC
+//!
+static u32 ckpt_crc32(const char *buf, size_t len)
+{
+    int j = 0;
+    size_t i = 0;
+    u32 crc = 0xFFFFFFFF;
+
+    for (i = 0; i < len; i++) {
+        crc ^= (unsigned char)buf[i];
+        for (j = 0; j < 8; j++) {
+            crc = ((crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1));
+        }
+    }
+    return (crc ^ 0xFFFFFFFF);
+}
+
+//!
+//! Stores the low bytes of a value, little-endian
+//!
+//! @param[out] buf where the bytes go
+//! @param[in]  val the value
+//! @param[in]  bytes how many bytes to store
+//!
+static void put_le(char *buf, unsigned long long val, int bytes)
+{
+    int i = 0;
+
+    for (i = 0; i < bytes; i++) {
+        buf[i] = (char)((val >> (8 * i)) & 0xff);
+    }
+}
+
+//!
+//! Loads a little-endian value
+//!
+//! @param[in] buf where the bytes are
+//! @param[in] bytes how many bytes to load
+//!
+//! @return the value
+//!
+static unsigned long long get_le(const char *buf, int bytes)
+{
+    int i = 0;
+    unsigned long long val = 0;
+
+    for (i = 0; i < bytes; i++) {
+        val |= ((unsigned long long)(unsigned char)buf[i]) << (8 * i);
+    }
+    return (val);
+}
+
+//!
+//! Appends a record, or only counts it if the writer has no buffer
+//!
+//! @param[in] w the writer
+//! @param[in] tag the tag of the record
+//! @param[in] index the index of the record
+//! @param[in] data the data of the record
+//! @param[in] len the length of the data
+//!
+static void put_record(ckpt_writer * w, u16 tag, u16 index, const char *data, size_t len)
+{
+    if (w->buf) {
+        put_le(w->buf + w->len, tag, 2);
+        put_le(w->buf + w->len + 2, index, 2);
+        put_le(w->buf + w->len + 4, len, 4);
+        memcpy(w->buf + w->len + INSTANCE_CHECKPOINT_RECORD_LEN, data, len);
+    }
+    w->len += INSTANCE_CHECKPOINT_RECORD_LEN + len;
+    w->records++;
+}
+
+//!
+//! Appends the record of a field, skipping empty strings and zeroes which read back as such anyway
+//!
+//! @param[in] w the writer
+//! @param[in] field the field
+//! @param[in] index the index of the record
+//! @param[in] base the struct the field is in
+//!
+static void put_field(ckpt_writer * w, const ckpt_field * field, u16 index, const char *base)
+{
+    const char *src = base + field->offset;
+    char num[8] = { 0 };
+    long long ival = 0;
+    unsigned long long bits = 0;
+    double dval = 0;
+
+    switch (field->kind) {
+    case CKPT_STR:
+        if (src[0] != '\0')
+            put_record(w, field->tag, index, src, strnlen(src, field->size - 1));
+        break;
+    case CKPT_INT:
+        switch (field->size) {
+        case 1:
+            ival = *((const unsigned char *)src);
+            break;
+        case 2:
+            ival = *((const short *)src);
+            break;
+        case 4:
+            ival = *((const int *)src);
+            break;
+        default:
+            ival = *((const long long *)src);
+            break;
+        }
+        if (ival != 0) {
+            put_le(num, (unsigned long long)ival, 8);
+            put_record(w, field->tag, index, num, 8);
+        }
+        break;
+    case CKPT_DBL:
+        memcpy(&dval, src, sizeof(double));
+        if (dval != 0) {
+            memcpy(&bits, &dval, sizeof(bits));
+            put_le(num, bits, 8);
+            put_record(w, field->tag, index, num, 8);
+        }
+        break;
+    }
+}
+
+//!
+//! Appends the records of a list of fields
+//!
+//! @param[in] w the writer
+//! @param[in] fields the fields
+//! @param[in] max_fields the number of fields
+//! @param[in] index the index of the records
+//! @param[in] base the struct the fields are in
+//!
+static void put_fields(ckpt_writer * w, const ckpt_field * fields, int max_fields, u16 index, const char *base)
+{
+    int i = 0;
+
+    for (i = 0; i < max_fields; i++) {
+        put_field(w, &(fields[i]), index, base);
+    }
+}
+
+//!
+//! Appends the records of an instance
+//!
+//! @param[in] w the writer
+//! @param[in] instance the instance
+//!
+static void encode_records(ckpt_writer * w, const ncInstance * instance)
+{
+    int i = 0;
+
+    put_fields(w, instance_fields, NELEMS(instance_fields), 0, (const char *)instance);
+    for (i = 0; (i < instance->groupNamesSize) && (i < EUCA_MAX_GROUPS); i++) {
+        put_record(w, TAG_GROUP_NAME, i, instance->groupNames[i], strnlen(instance->groupNames[i], CHAR_BUFFER_SIZE - 1));
+    }
+    for (i = 0; (i < instance->params.virtualBootRecordLen) && (i < EUCA_MAX_VBRS); i++) {
+        put_fields(w, vbr_fields, NELEMS(vbr_fields), i, (const char *)&(instance->params.virtualBootRecord[i]));
+    }
+    for (i = 0; i < EUCA_MAX_VOLUMES; i++) {
+        if (instance->volumes[i].volumeId[0] != '\0')
+            put_fields(w, volume_fields, NELEMS(volume_fields), i, (const char *)&(instance->volumes[i]));
+    }
+}
+
+//!
+//! Encodes an instance into a checkpoint
+//!
+//! @param[in]  instance the instance
+//! @param[out] out_buf the checkpoint, to be freed by the caller
+//! @param[out] out_len the length of the checkpoint
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or EUCA_MEMORY_ERROR
+//!
+int encode_instance_checkpoint(const ncInstance * instance, char **out_buf, size_t * out_len)
+{
+    char *buf = NULL;
+    ckpt_writer w = { 0 };
+
+    if (!instance || !out_buf || !out_len)
+        return (EUCA_INVALID_ERROR);
+
+    // size the checkpoint first, so that it is built in one exactly sized buffer
+    encode_records(&w, instance);
+    if ((buf = EUCA_ALLOC(INSTANCE_CHECKPOINT_HEADER_LEN + w.len, sizeof(char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    bzero(&w, sizeof(w));
+    w.buf = buf + INSTANCE_CHECKPOINT_HEADER_LEN;
+    encode_records(&w, instance);
+
+    bzero(buf, INSTANCE_CHECKPOINT_HEADER_LEN);
+    memcpy(buf, INSTANCE_CHECKPOINT_MAGIC, 8);
+    put_le(buf + 8, INSTANCE_CHECKPOINT_VERSION, 2);
+    put_le(buf + 10, INSTANCE_CHECKPOINT_HEADER_LEN, 2);
+    put_le(buf + 12, w.records, 4);
+    put_le(buf + 16, w.len, 4);
+    put_le(buf + 20, ckpt_crc32(w.buf, w.len), 4);
+    put_le(buf + 24, ckpt_crc32(buf, 24), 4);
+
+    *out_buf = buf;
+    *out_len = INSTANCE_CHECKPOINT_HEADER_LEN + w.len;
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the field of a tag
+//!
+//! @param[in] fields the fields to look in
+//! @param[in] max_fields the number of fields
+//! @param[in] tag the tag
+//!
+//! @return the field or NULL if the tag is unknown
+//!
+static const ckpt_field *find_field(const ckpt_field * fields, int max_fields, u16 tag)
+{
+    int i = 0;
+
+    // fields are numbered from 1 in table order, so the tag usually points right at its field
+    i = (tag & 0xff) - 1;
+    if ((i >= 0) && (i < max_fields) && (fields[i].tag == tag))
+        return (&(fields[i]));
+    for (i = 0; i < max_fields; i++) {
+        if (fields[i].tag == tag)
+            return (&(fields[i]));
+    }
+    return (NULL);
+}
+
+//!
+//! Finds the field at an offset of its struct
+//!
+//! @param[in] fields the fields to look in
+//! @param[in] max_fields the number of fields
+//! @param[in] offset the offset of the field, e.g. offsetof(ncInstance, userData)
+//!
+//! @return the field or NULL if no field of the schema starts there
+//!
+static const ckpt_field *find_field_at(const ckpt_field * fields, int max_fields, size_t offset)
+{
+    int i = 0;
+
+    for (i = 0; i < max_fields; i++) {
+        if (fields[i].offset == offset)
+            return (&(fields[i]));
+    }
+    return (NULL);
+}
+
+//!
+//! Sets a field from the data of its record. Strings longer than the field are cut, numbers
+//! are cut to the size of the field, and records of the wrong size for a number are ignored.
+//!
+//! @param[in] field the field
+//! @param[in] data the data of the record
+//! @param[in] len the length of the data
+//! @param[in] base the struct the field is in
+//!
+static void get_field(const ckpt_field * field, const char *data, size_t len, char *base)
+{
+    char *dst = base + field->offset;
+    long long ival = 0;
+    unsigned long long bits = 0;
+    double dval = 0;
+
+    switch (field->kind) {
+    case CKPT_STR:
+        if (len > (field->size - 1))
+            len = field->size - 1;
+        memcpy(dst, data, len);
+        dst[len] = '\0';
+        break;
+    case CKPT_INT:
+        if (len != 8)
+            break;
+        ival = (long long)get_le(data, 8);
+        switch (field->size) {
+        case 1:
+            *((unsigned char *)dst) = (unsigned char)ival;
+            break;
+        case 2:
+            *((short *)dst) = (short)ival;
+            break;
+        case 4:
+            *((int *)dst) = (int)ival;
+            break;
+        default:
+            *((long long *)dst) = ival;
+            break;
+        }
+        break;
+    case CKPT_DBL:
+        if (len != 8)
+            break;
+        bits = get_le(data, 8);
+        memcpy(&dval, &bits, sizeof(dval));
+        memcpy(dst, &dval, sizeof(double));
+        break;
+    }
+}
+
+//!
+//! Sets the fields of an instance from a run of records
+//!
+//! @param[in]  p the first record
+//! @param[in]  end the end of the records
+//! @param[in]  records the number of records
+//! @param[out] instance the instance to set
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR if a record runs past the end
+//!
+static int decode_records(const char *p, const char *end, u32 records, ncInstance * instance)
+{
+    u32 i = 0;
+    u16 tag = 0;
+    u16 index = 0;
+    size_t rec_len = 0;
+    const ckpt_field *field = NULL;
+
+    for (i = 0; i < records; i++) {
+        if ((end - p) < INSTANCE_CHECKPOINT_RECORD_LEN)
+            return (EUCA_IO_ERROR);
+        tag = get_le(p, 2);
+        index = get_le(p + 2, 2);
+        rec_len = get_le(p + 4, 4);
+        p += INSTANCE_CHECKPOINT_RECORD_LEN;
+        if (rec_len > (size_t) (end - p))
+            return (EUCA_IO_ERROR);
+
+        switch (tag & 0xff00) {
+        case TAG_INSTANCE:
+            if ((field = find_field(instance_fields, NELEMS(instance_fields), tag)) != NULL)
+                get_field(field, p, rec_len, (char *)instance);
+            break;
+        case TAG_GROUP_NAME:
+            if ((tag == TAG_GROUP_NAME) && (index < EUCA_MAX_GROUPS)) {
+                if (rec_len > (CHAR_BUFFER_SIZE - 1))
+                    rec_len = CHAR_BUFFER_SIZE - 1;
+                memcpy(instance->groupNames[index], p, rec_len);
+                instance->groupNames[index][rec_len] = '\0';
+            }
+            break;
+        case TAG_VBR:
+            if ((index < EUCA_MAX_VBRS) && ((field = find_field(vbr_fields, NELEMS(vbr_fields), tag)) != NULL))
+                get_field(field, p, rec_len, (char *)&(instance->params.virtualBootRecord[index]));
+            break;
+        case TAG_VOLUME:
+            if ((index < EUCA_MAX_VOLUMES) && ((field = find_field(volume_fields, NELEMS(volume_fields), tag)) != NULL))
+                get_field(field, p, rec_len, (char *)&(instance->volumes[index]));
+            break;
+        default:
+            // written by a newer version, which knows what to do with it
+            break;
+        }
+        p += rec_len;
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//! Decodes a checkpoint into an instance. Only the fields present in the checkpoint are set,
+//! so the instance should be zeroed beforehand. The buffer is not modified and may be a
+//! read-only mapping of the file.
+//!
+//! @param[in]  buf the checkpoint
+//! @param[in]  len its length
+//! @param[out] instance the instance to set
+//! @param[out] out_version the format version of the checkpoint, if not NULL
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if this is not a checkpoint or one of a newer
+//!         version, or EUCA_IO_ERROR if it is corrupt
+//!
+int decode_instance_checkpoint(const char *buf, size_t len, ncInstance * instance, int *out_version)
+{
+    int ret = EUCA_OK;
+    int version = 0;
+    u32 records = 0;
+    size_t header_len = 0;
+    size_t payload_len = 0;
+
+    if (!buf || !instance)
+        return (EUCA_INVALID_ERROR);
+
+    if ((len < INSTANCE_CHECKPOINT_HEADER_LEN) || memcmp(buf, INSTANCE_CHECKPOINT_MAGIC, 8))
+        return (EUCA_INVALID_ERROR);
+
+    version = get_le(buf + 8, 2);
+    header_len = get_le(buf + 10, 2);
+    records = get_le(buf + 12, 4);
+    payload_len = get_le(buf + 16, 4);
+    if (version > INSTANCE_CHECKPOINT_VERSION) {
+        LOGWARN("instance checkpoint is of version %d, newer than %d\n", version, INSTANCE_CHECKPOINT_VERSION);
+        return (EUCA_INVALID_ERROR);
+    }
+    if ((header_len < INSTANCE_CHECKPOINT_HEADER_LEN) || (get_le(buf + 24, 4) != ckpt_crc32(buf, 24))
+        || (header_len > len) || (payload_len != (len - header_len)) || (get_le(buf + 20, 4) != ckpt_crc32(buf + header_len, payload_len))) {
+        return (EUCA_IO_ERROR);
+    }
+
+    if ((ret = decode_records((buf + header_len), (buf + len), records, instance)) != EUCA_OK)
+        return (ret);
+
+    // counts that index the arrays must not point past them, whatever the file says
+    if ((instance->params.virtualBootRecordLen < 0) || (instance->params.virtualBootRecordLen > EUCA_MAX_VBRS))
+        instance->params.virtualBootRecordLen = 0;
+    if ((instance->groupNamesSize < 0) || (instance->groupNamesSize > EUCA_MAX_GROUPS))
+        instance->groupNamesSize = 0;
+
+    if (out_version)
+        *out_version = version;
+    return (EUCA_OK);
+}
+
+//!
+//! Writes the checkpoint of an instance to a file, by renaming a new file over the old one so
+//! that readers, and the NC after a crash, never see a partially written checkpoint
+//!
+//! @param[in] instance the instance
+//! @param[in] path the path of the checkpoint
+//! @param[in] mode the permissions of the file
+//! @param[in] durable whether to flush the file to disk before it replaces the old one
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters, EUCA_MEMORY_ERROR or EUCA_IO_ERROR
+//!
+int write_instance_checkpoint(const ncInstance * instance, const char *path, mode_t mode, boolean durable)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+    char *buf = NULL;
+    char tmp_path[EUCA_MAX_PATH] = "";
+    size_t len = 0;
+    ssize_t written = 0;
+
+    if (!instance || !path)
+        return (EUCA_INVALID_ERROR);
+
+    if ((ret = encode_instance_checkpoint(instance, &buf, &len)) != EUCA_OK)
+        return (ret);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, mode)) < 0) {
+        LOGERROR("[%s] failed to create instance checkpoint %s: %s\n", instance->instanceId, tmp_path, strerror(errno));
+        EUCA_FREE(buf);
+        return (EUCA_IO_ERROR);
+    }
+    fchmod(fd, mode);
+
+    written = write(fd, buf, len);
+    EUCA_FREE(buf);
+    if ((written != (ssize_t) len) || (durable && fsync(fd))) {
+        LOGERROR("[%s] failed to write instance checkpoint %s: %s\n", instance->instanceId, tmp_path, strerror(errno));
+        ret = EUCA_IO_ERROR;
+    }
+    if (close(fd) && (ret == EUCA_OK)) {
+        ret = EUCA_IO_ERROR;
+    }
+
+    if ((ret == EUCA_OK) && rename(tmp_path, path)) {
+        LOGERROR("[%s] failed to rename instance checkpoint to %s: %s\n", instance->instanceId, path, strerror(errno));
+        ret = EUCA_IO_ERROR;
+    }
+    if (ret != EUCA_OK) {
+        unlink(tmp_path);
+    } else {
+        LOGTRACE("[%s] wrote %lu-byte instance checkpoint to %s\n", instance->instanceId, (unsigned long)len, path);
+    }
+    return (ret);
+}
+
+//!
+//! Reads the checkpoint of an instance from a file, with a single read or mapping of the file
+//!
+//! @param[in]  path the path of the checkpoint
+//! @param[out] instance the instance to set, which should be zeroed beforehand
+//! @param[out] out_version the format version of the checkpoint, if not NULL
+//!
+//! @return EUCA_OK on success or the error of file_view_open() or decode_instance_checkpoint()
+//!
+int read_instance_checkpoint(const char *path, ncInstance * instance, int *out_version)
+{
+    int ret = EUCA_OK;
+    file_view view = { 0 };
+
+    if (!path || !instance)
+        return (EUCA_INVALID_ERROR);
+
+    if ((ret = file_view_open(path, INSTANCE_CHECKPOINT_MAX_LEN, &view)) != EUCA_OK)
+        return (ret);
+    ret = decode_instance_checkpoint(view.data, view.len, instance, out_version);
+    file_view_close(&view);
+    return (ret);
+}
+
+//!
+//! Makes a compact copy of an instance
+//!
+//! @param[in]  instance the instance
+//! @param[out] compact the copy, to be freed with free_compact_instance()
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or EUCA_MEMORY_ERROR
+//!
+int compact_instance(const ncInstance * instance, ncInstanceCompact * compact)
+{
+    int i = 0;
+    size_t id_len = 0;
+    ckpt_writer w = { 0 };
+    const virtualMachine *vm = NULL;
+    virtualBootRecord *const *ptrs[COMPACT_INSTANCE_VBR_POINTERS] = { NULL };
+
+    if (!instance || !compact)
+        return (EUCA_INVALID_ERROR);
+
+    bzero(compact, sizeof(ncInstanceCompact));
+    encode_records(&w, instance);
+    id_len = strnlen(instance->instanceId, sizeof(instance->instanceId) - 1);
+    if ((compact->pool = EUCA_ALLOC((w.len + id_len + 1), sizeof(char))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    compact->records = w.records;
+    compact->recordsLen = w.len;
+    bzero(&w, sizeof(w));
+    w.buf = compact->pool;
+    encode_records(&w, instance);
+    memcpy(compact->pool + w.len, instance->instanceId, id_len);
+    compact->pool[w.len + id_len] = '\0';
+    compact->instanceId = compact->pool + w.len;
+
+    compact->state = instance->state;
+    compact->migration_state = instance->migration_state;
+    compact->launchTime = instance->launchTime;
+    compact->terminationTime = instance->terminationTime;
+    compact->generation = instance->generation;
+    compact->tcb = instance->tcb;
+
+    // the VBR pointers are kept as indexes into the VBRs
+    vm = &(instance->params);
+    ptrs[0] = &(vm->root);
+    ptrs[1] = &(vm->kernel);
+    ptrs[2] = &(vm->ramdisk);
+    ptrs[3] = &(vm->swap);
+    ptrs[4] = &(vm->ephemeral0);
+    ptrs[5] = &(vm->boot);
+    for (i = 0; i < COMPACT_INSTANCE_VBR_POINTERS; i++) {
+        compact->vbrs[i] = -1;
+        if ((*ptrs[i] >= vm->virtualBootRecord) && (*ptrs[i] < (vm->virtualBootRecord + EUCA_MAX_VBRS)))
+            compact->vbrs[i] = (signed char)(*ptrs[i] - vm->virtualBootRecord);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Gets an instance back from its compact copy
+//!
+//! @param[in]  compact the copy
+//! @param[out] instance the instance, which is overwritten entirely
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or EUCA_IO_ERROR if the
+//!         pool is damaged
+//!
+int expand_instance(const ncInstanceCompact * compact, ncInstance * instance)
+{
+    int ret = EUCA_OK;
+    virtualMachine *vm = NULL;
+
+    if (!compact || !compact->pool || !instance)
+        return (EUCA_INVALID_ERROR);
+
+    bzero(instance, sizeof(ncInstance));
+    if ((ret = decode_records(compact->pool, (compact->pool + compact->recordsLen), compact->records, instance)) != EUCA_OK)
+        return (ret);
+
+    instance->generation = compact->generation;
+    instance->tcb = compact->tcb;
+    vm = &(instance->params);
+    vm->root = ((compact->vbrs[0] < 0) ? NULL : &(vm->virtualBootRecord[(int)compact->vbrs[0]]));
+    vm->kernel = ((compact->vbrs[1] < 0) ? NULL : &(vm->virtualBootRecord[(int)compact->vbrs[1]]));
+    vm->ramdisk = ((compact->vbrs[2] < 0) ? NULL : &(vm->virtualBootRecord[(int)compact->vbrs[2]]));
+    vm->swap = ((compact->vbrs[3] < 0) ? NULL : &(vm->virtualBootRecord[(int)compact->vbrs[3]]));
+    vm->ephemeral0 = ((compact->vbrs[4] < 0) ? NULL : &(vm->virtualBootRecord[(int)compact->vbrs[4]]));
+    vm->boot = ((compact->vbrs[5] < 0) ? NULL : &(vm->virtualBootRecord[(int)compact->vbrs[5]]));
+    return (EUCA_OK);
+}
+
+//!
+//! Frees the pool of a compact copy of an instance
+//!
+//! @param[in,out] compact the copy, which is zeroed
+//!
+void free_compact_instance(ncInstanceCompact * compact)
+{
+    if (compact) {
+        EUCA_FREE(compact->pool);
+        bzero(compact, sizeof(ncInstanceCompact));
+    }
+}
+
+//!
+//! Gets a field out of the pool of a compact copy. A string is NUL-terminated and cut to the
+//! size of the buffer, a number needs a buffer of its exact size. A field without a record is
+//! set, as it would be in the instance, to an empty string or zero.
+//!
+//! @param[in]  compact the copy
+//! @param[in]  field the field
+//! @param[in]  index the index of the record
+//! @param[out] buf where the value goes
+//! @param[in]  size size of buf
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the buffer does not fit the field
+//!
+static int get_compact_field(const ncInstanceCompact * compact, const ckpt_field * field, u16 index, void *buf, size_t size)
+{
+    u32 i = 0;
+    size_t rec_len = 0;
+    const char *p = compact->pool;
+    const char *end = compact->pool + compact->recordsLen;
+
+    if ((size == 0) || ((field->kind != CKPT_STR) && (size != field->size)))
+        return (EUCA_INVALID_ERROR);
+
+    bzero(buf, size);
+    for (i = 0; (i < compact->records) && ((end - p) >= INSTANCE_CHECKPOINT_RECORD_LEN); i++) {
+        rec_len = get_le(p + 4, 4);
+        if ((get_le(p, 2) == field->tag) && (get_le(p + 2, 2) == index)) {
+            p += INSTANCE_CHECKPOINT_RECORD_LEN;
+            if (field->kind == CKPT_STR) {
+                rec_len = MIN(rec_len, (size - 1));
+                memcpy(buf, p, rec_len);
+            } else {
+                // get_field() puts the value at the offset of the field in its struct
+                get_field(field, p, rec_len, (((char *)buf) - field->offset));
+            }
+            break;
+        }
+        p += INSTANCE_CHECKPOINT_RECORD_LEN + rec_len;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Gets a field of the instance out of its compact copy, e.g. the user data with
+//! compact_instance_field(compact, offsetof(ncInstance, userData), buf, sizeof(buf))
+//!
+//! @param[in]  compact the copy
+//! @param[in]  offset the offset of the field in ncInstance
+//! @param[out] buf where the value goes, see get_compact_field()
+//! @param[in]  size size of buf
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR on bad parameters or for a field that the
+//!         records do not keep
+//!
+int compact_instance_field(const ncInstanceCompact * compact, size_t offset, void *buf, size_t size)
+{
+    const ckpt_field *field = NULL;
+
+    if (!compact || !compact->pool || !buf || ((field = find_field_at(instance_fields, NELEMS(instance_fields), offset)) == NULL))
+        return (EUCA_INVALID_ERROR);
+    return (get_compact_field(compact, field, 0, buf, size));
+}
+
+//!
+//! Gets a field of a VBR of the instance out of its compact copy, e.g. the location of the root
+//! with compact_vbr_field(compact, 0, offsetof(virtualBootRecord, resourceLocation), buf, sizeof(buf))
+//!
+//! @param[in]  compact the copy
+//! @param[in]  index the VBR in params.virtualBootRecord
+//! @param[in]  offset the offset of the field in virtualBootRecord
+//! @param[out] buf where the value goes, see get_compact_field()
+//! @param[in]  size size of buf
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR on bad parameters
+//!
+int compact_vbr_field(const ncInstanceCompact * compact, int index, size_t offset, void *buf, size_t size)
+{
+    const ckpt_field *field = NULL;
+
+    if (!compact || !compact->pool || !buf || (index < 0) || (index >= EUCA_MAX_VBRS)
+        || ((field = find_field_at(vbr_fields, NELEMS(vbr_fields), offset)) == NULL))
+        return (EUCA_INVALID_ERROR);
+    return (get_compact_field(compact, field, index, buf, size));
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int main(int argc, char **argv)
+{
+    int errors = 0;
+    int version = 0;
+    char *buf = NULL;
+    char path[] = "/tmp/euca-checkpoint-XXXXXX";
+    char small[6] = "";
+    size_t len = 0;
+    long long netbytes = 0;
+    ncInstance *in = NULL;
+    ncInstance *out = NULL;
+    ncInstanceCompact compact = { 0 };
+
+    logfile(NULL, EUCA_LOG_DEBUG, 4);
+    in = EUCA_ZALLOC(1, sizeof(ncInstance));
+    out = EUCA_ZALLOC(1, sizeof(ncInstance));
+    if (!in || !out) {
+        LOGERROR("out of memory\n");
+        return (EUCA_ERROR);
+    }
+
+    snprintf(in->instanceId, sizeof(in->instanceId), "i-12345678");
+    snprintf(in->userId, sizeof(in->userId), "user");
+    snprintf(in->keyName, sizeof(in->keyName), "ssh-rsa AAAA");
+    in->state = BOOTING;
+    in->launchTime = 1400000000;
+    in->blkbytes = -1;
+    in->netbytes = 1LL << 40;
+    in->bundleTaskProgress = 0.25;
+    in->combinePartitions = TRUE;
+    in->params.mem = 512;
+    in->params.virtualBootRecordLen = 2;
+    snprintf(in->params.virtualBootRecord[0].resourceLocation, CHAR_BUFFER_SIZE, "http://osg/emi-1");
+    in->params.virtualBootRecord[0].sizeBytes = 10LL << 30;
+    snprintf(in->params.virtualBootRecord[1].guestDeviceName, SMALL_CHAR_BUFFER_SIZE, "sda2");
+    in->groupNamesSize = 1;
+    snprintf(in->groupNames[0], CHAR_BUFFER_SIZE, "default");
+    snprintf(in->volumes[3].volumeId, CHAR_BUFFER_SIZE, "vol-1");
+    snprintf(in->volumes[3].connectionString, VERY_BIG_CHAR_BUFFER_SIZE, "iqn.2014");
+
+    if (encode_instance_checkpoint(in, &buf, &len) != EUCA_OK) {
+        LOGERROR("encoding failed\n");
+        return (EUCA_ERROR);
+    }
+    LOGINFO("checkpoint is %lu bytes, the struct %lu\n", (unsigned long)len, (unsigned long)sizeof(ncInstance));
+    if ((decode_instance_checkpoint(buf, len, out, &version) != EUCA_OK) || (version != INSTANCE_CHECKPOINT_VERSION) || memcmp(in, out, sizeof(ncInstance))) {
+        LOGERROR("instance did not survive the round trip\n");
+        errors++;
+    }
+
+    // a flipped bit is caught
+    buf[len - 1] ^= 1;
+    bzero(out, sizeof(ncInstance));
+    if (decode_instance_checkpoint(buf, len, out, NULL) != EUCA_IO_ERROR) {
+        LOGERROR("corruption went unnoticed\n");
+        errors++;
+    }
+    buf[len - 1] ^= 1;
+
+    // newer versions are refused
+    put_le(buf + 8, INSTANCE_CHECKPOINT_VERSION + 1, 2);
+    put_le(buf + 24, ckpt_crc32(buf, 24), 4);
+    if (decode_instance_checkpoint(buf, len, out, NULL) != EUCA_INVALID_ERROR) {
+        LOGERROR("newer version was accepted\n");
+        errors++;
+    }
+    EUCA_FREE(buf);
+
+    // through a file
+    close(safe_mkstemp(path));
+    bzero(out, sizeof(ncInstance));
+    if ((write_instance_checkpoint(in, path, 0600, TRUE) != EUCA_OK) || (read_instance_checkpoint(path, out, NULL) != EUCA_OK) || memcmp(in, out, sizeof(ncInstance))) {
+        LOGERROR("instance did not survive the trip through %s\n", path);
+        errors++;
+    }
+    unlink(path);
+
+    // the compact copy, with the pointers into the VBRs
+    in->params.root = &(in->params.virtualBootRecord[0]);
+    bzero(out, sizeof(ncInstance));
+    if ((compact_instance(in, &compact) != EUCA_OK) || (expand_instance(&compact, out) != EUCA_OK) || (out->params.root != &(out->params.virtualBootRecord[0]))
+        || ((out->params.root = in->params.root) == NULL) || memcmp(in, out, sizeof(ncInstance))) {
+        LOGERROR("instance did not survive the compact copy\n");
+        errors++;
+    }
+    LOGINFO("compact copy is %lu bytes\n", (unsigned long)(sizeof(compact) + compact.recordsLen + strlen(compact.instanceId) + 1));
+    if (strcmp(compact.instanceId, in->instanceId) || (compact.state != in->state) || (compact.vbrs[0] != 0) || (compact.vbrs[1] != -1)) {
+        LOGERROR("compact copy has wrong fixed fields\n");
+        errors++;
+    }
+    if ((compact_instance_field(&compact, offsetof(ncInstance, keyName), small, sizeof(small)) != EUCA_OK) || strcmp(small, "ssh-r")
+        || (compact_instance_field(&compact, offsetof(ncInstance, userData), small, sizeof(small)) != EUCA_OK) || (small[0] != '\0')
+        || (compact_instance_field(&compact, offsetof(ncInstance, netbytes), &netbytes, sizeof(netbytes)) != EUCA_OK) || (netbytes != in->netbytes)
+        || (compact_vbr_field(&compact, 0, offsetof(virtualBootRecord, resourceLocation), small, sizeof(small)) != EUCA_OK) || strcmp(small, "http:")
+        || (compact_instance_field(&compact, offsetof(ncInstance, params.root), small, sizeof(small)) != EUCA_INVALID_ERROR)) {
+        LOGERROR("fields of the compact copy are wrong\n");
+        errors++;
+    }
+    free_compact_instance(&compact);
+    in->params.root = NULL;
+
+    EUCA_FREE(in);
+    EUCA_FREE(out);
+    printf("checkpoint tests %s\n", ((errors == 0) ? "passed" : "FAILED"));
+    return ((errors == 0) ? EUCA_OK : EUCA_ERROR);
+}
+#endif /* _UNIT_TEST */
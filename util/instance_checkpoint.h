@@ -0,0 +1,189 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+
+#ifndef _INCLUDE_INSTANCE_CHECKPOINT_H_
+#define _INCLUDE_INSTANCE_CHECKPOINT_H_
+
+//!
+//! @file util/instance_checkpoint.h
+//! Compact binary checkpoint of the instance struct, which the NC loads in place of the
+//! instance XML when it is current. The format is a fixed header followed by tagged fields:
+//!
+//!     header:  magic[8] version:u16 header_len:u16 records:u32 payload_len:u32 payload_crc:u32 header_crc:u32 reserved:u32
+//!     record:  tag:u16 index:u16 len:u32 data[len]
+//!
+//! All integers are little-endian and the CRCs are CRC-32 (IEEE). Strings are stored without
+//! their padding, numbers as 64-bit integers and arrays as one record per element, with the
+//! element in the index. Readers skip the tags they do not know and leave the fields that are
+//! not in the file zeroed, so fields can be added without a version bump; the version only
+//! goes up when the meaning of an existing tag changes, and readers refuse newer versions.
+//!
+//! The same records make up the pool of ncInstanceCompact, an in-memory copy of an instance
+//! for code that holds on to copies without working on them.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "data.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define INSTANCE_CHECKPOINT_MAGIC                "EUCAINST" //!< first 8 bytes of a checkpoint
+#define INSTANCE_CHECKPOINT_VERSION              1  //!< format version written by this code
+#define INSTANCE_CHECKPOINT_HEADER_LEN           32 //!< size of the version 1 header
+#define INSTANCE_CHECKPOINT_RECORD_LEN           8  //!< size of the header of a field record
+#define INSTANCE_CHECKPOINT_MAX_LEN              (4 * 1024 * 1024)  //!< largest checkpoint accepted
+#define COMPACT_INSTANCE_VBR_POINTERS            6  //!< VBR pointers of virtualMachine, root through boot
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Compact copy of an instance. The fixed part has what holders of copies look at and fits in
+//! a cache line. Every other field, among them the user data, the credentials, the URLs and
+//! the locations of the VBRs, is in the pool as a record that is only as long as its content,
+//! so a copy takes a few KB where ncInstance takes hundreds. Use expand_instance() to get the
+//! instance back, or compact_instance_field() and compact_vbr_field() for single fields.
+typedef struct ncInstanceCompact_t {
+    const char *instanceId;            //!< the instance identifier string, at the end of the pool
+    instance_states state;             //!< Instance state
+    migration_states migration_state;  //!< Migration state
+    int launchTime;                    //!< timestamp of RunInstances request arrival
+    int terminationTime;               //!< timestamp of when resources are released
+    long long generation;              //!< instance list generation, which the records do not keep
+    pthread_t tcb;                     //!< Instance thread, which the records do not keep
+    signed char vbrs[COMPACT_INSTANCE_VBR_POINTERS];    //!< which VBRs params.root through params.boot point at, -1 for none
+    u32 records;                       //!< number of records in the pool
+    u32 recordsLen;                    //!< length of the records, the instance identifier follows them
+    char *pool;                        //!< the records of the fields that are set, then the NUL-terminated instance ID
+} ncInstanceCompact;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+int encode_instance_checkpoint(const ncInstance * instance, char **out_buf, size_t * out_len);
+int decode_instance_checkpoint(const char *buf, size_t len, ncInstance * instance, int *out_version);
+int write_instance_checkpoint(const ncInstance * instance, const char *path, mode_t mode, boolean durable);
+int read_instance_checkpoint(const char *path, ncInstance * instance, int *out_version);
+int compact_instance(const ncInstance * instance, ncInstanceCompact * compact);
+int expand_instance(const ncInstanceCompact * compact, ncInstance * instance);
+void free_compact_instance(ncInstanceCompact * compact);
+int compact_instance_field(const ncInstanceCompact * compact, size_t offset, void *buf, size_t size);
+int compact_vbr_field(const ncInstanceCompact * compact, int index, size_t offset, void *buf, size_t size);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_INSTANCE_CHECKPOINT_H_ */
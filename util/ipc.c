@@ -87,10 +87,13 @@
 #include <string.h>
 #include <strings.h>
 #include <assert.h>
+#include <time.h>
 
 #include "eucalyptus.h"
 #include "misc.h"                      /* logprintfl */
 #include "ipc.h"
+#include "euca_string.h"
+#include "euca_probe.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -98,6 +101,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define SEM_STATS_HELD_MAX                            8 //!< most registered semaphores a thread can hold at once and have their hold times measured
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -116,6 +121,14 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A registered semaphore held by a thread, so that the hold can be timed on release
+typedef struct semHeld_t {
+    sem *pSem;                         //!< the semaphore
+    long long since_usec;              //!< when it was acquired
+    const char *file;                  //!< where it was acquired
+    int line;                          //!< where it was acquired
+} semHeld;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -136,12 +149,25 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static semStats *sem_stats_registry[SEM_STATS_MAX] = { NULL };  //!< the statistics of the registered semaphores
+static int sem_stats_len = 0;          //!< number of entries in sem_stats_registry
+static volatile boolean sem_stats_on = FALSE;   //!< whether statistics are collected
+static pthread_mutex_t sem_stats_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards sem_stats_registry
+
+static __thread semHeld sem_held[SEM_STATS_HELD_MAX];   //!< the registered semaphores held by this thread
+static __thread int sem_held_len = 0;  //!< number of entries in sem_held
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static long long sem_stats_usec(void);
+static int sem_stats_bucket(long long usec);
+static void sem_stats_acquired(sem * pSem, long long start_usec, const char *file, int line);
+static void sem_stats_released(sem * pSem);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -320,6 +346,18 @@ void sem_free(sem * pSem)
 
     // Make sure we were provided with a valid semaphore
     if (pSem) {
+        // Forget its statistics
+        if (pSem->stats) {
+            pthread_mutex_lock(&sem_stats_mutex);
+            for (int i = 0; i < sem_stats_len; i++) {
+                if (sem_stats_registry[i] == pSem->stats) {
+                    sem_stats_registry[i] = sem_stats_registry[--sem_stats_len];
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&sem_stats_mutex);
+            EUCA_FREE(pSem->stats);
+        }
         // Is this a posix semaphore?
         if (pSem->posix) {
             // Close the posix semaphore
@@ -348,10 +386,13 @@ void sem_free(sem * pSem)
 //!
 //! Semaphore increment (aka lock acquisition) function. The second parameter
 //! tells it not to log the event (useful for avoiding infinite recursion when
-//! locking from the logging code).
+//! locking from the logging code). Called through the sem_prolaag() and sem_p()
+//! macros, which pass the call site along for the statistics.
 //!
 //! @param[in] pSem  a pointer to the semaphore to acquire
 //! @param[in] doLog set to TRUE if we need to log this acquisition. Otherwise set to FALSE.
+//! @param[in] file  the file from which the semaphore is acquired
+//! @param[in] line  the line from which the semaphore is acquired
 //!
 //! @return 0 on success or any other values on failure
 //!
@@ -359,9 +400,10 @@ void sem_free(sem * pSem)
 //!
 //! @post On success, the sempahore is acquired
 //!
-int sem_prolaag(sem * pSem, boolean doLog)
+int sem_prolaag_at(sem * pSem, boolean doLog, const char *file, int line)
 {
-    int rc = 0;
+    int rc = -1;
+    long long start_usec = 0;
     struct sembuf sb = { 0, -1, 0 };
 
     // Make sure our given semaphore is valid
@@ -370,8 +412,13 @@ int sem_prolaag(sem * pSem, boolean doLog)
         if (doLog) {
             LOGEXTREME("%s locking\n", pSem->name);
         }
-        // For mutex semaphore
+        if (pSem->stats && sem_stats_on) {
+            start_usec = sem_stats_usec();
+        }
+        EUCA_PROBE1(sem__wait__start, pSem->name);
+
         if (pSem->usemutex) {
+            // For mutex semaphore
             rc = pthread_mutex_lock(&(pSem->mutex));
             pSem->mutwaiters++;
             while (pSem->mutcount == 0) {
@@ -381,33 +428,21 @@ int sem_prolaag(sem * pSem, boolean doLog)
             pSem->mutwaiters--;
             pSem->mutcount--;
             rc = pthread_mutex_unlock(&(pSem->mutex));
-            return (rc);
-        }
-        // For Posix semaphore
-        if (pSem->posix) {
-            return (sem_wait(pSem->posix));
+        } else if (pSem->posix) {
+            // For Posix semaphore
+            rc = sem_wait(pSem->posix);
+        } else if (pSem->sysv > 0) {
+            // For SYS V semaphore
+            rc = semop(pSem->sysv, &sb, 1);
         }
-        // For SYS V semaphore
-        if (pSem->sysv > 0) {
-            return (semop(pSem->sysv, &sb, 1));
+
+        EUCA_PROBE2(sem__wait__done, pSem->name, rc);
+        if ((rc == 0) && (start_usec > 0)) {
+            sem_stats_acquired(pSem, start_usec, file, line);
         }
     }
 
-    return (-1);
-}
-
-//!
-//! The semaphore increment (aka lock acquisition) function used throughout.
-//!
-//! @param[in] pSem a pointer to the semaphore to acquire
-//!
-//! @return the result from sem_prolaag()
-//!
-//! @see sem_prolaag()
-//!
-int sem_p(sem * pSem)
-{
-    return (sem_prolaag(pSem, TRUE));
+    return (rc);
 }
 
 //!
@@ -435,6 +470,9 @@ int sem_verhogen(sem * pSem, boolean doLog)
         if (doLog) {
             LOGEXTREME("%s unlocking\n", pSem->name);
         }
+        if (pSem->stats) {
+            sem_stats_released(pSem);
+        }
         // For mutex semaphore
         if (pSem->usemutex) {
             rc = pthread_mutex_lock(&(pSem->mutex));
@@ -472,3 +510,174 @@ int sem_v(sem * pSem)
 {
     return (sem_verhogen(pSem, TRUE));
 }
+
+//!
+//! Returns the current time on the cheap fast_ticks() timer, in microseconds since an arbitrary point
+//!
+//! @return the current time in microseconds
+//!
+static long long sem_stats_usec(void)
+{
+    return (fast_ticks_usec(fast_ticks()) + 1);
+}
+
+//!
+//! Returns the histogram bucket of a duration: 0 below 10us, 1 below 100us and so on.
+//!
+//! @param[in] usec the duration in microseconds
+//!
+//! @return the bucket, in [0..SEM_STATS_BUCKETS-1]
+//!
+static int sem_stats_bucket(long long usec)
+{
+    int bucket = 0;
+
+    for (long long limit = 10; (usec >= limit) && (bucket < (SEM_STATS_BUCKETS - 1)); limit *= 10)
+        bucket++;
+    return (bucket);
+}
+
+//!
+//! Accounts for an acquisition of a registered semaphore and remembers, for this thread,
+//! when and where it was acquired.
+//!
+//! @param[in] pSem the semaphore that was acquired
+//! @param[in] start_usec when the acquisition started
+//! @param[in] file where it was acquired
+//! @param[in] line where it was acquired
+//!
+static void sem_stats_acquired(sem * pSem, long long start_usec, const char *file, int line)
+{
+    long long now = sem_stats_usec();
+    semStats *stats = pSem->stats;
+
+    __sync_fetch_and_add(&(stats->acquisitions), 1);
+    __sync_fetch_and_add(&(stats->wait_usec), (now - start_usec));
+    __sync_fetch_and_add(&(stats->wait_hist[sem_stats_bucket(now - start_usec)]), 1);
+
+    if (sem_held_len < SEM_STATS_HELD_MAX) {
+        sem_held[sem_held_len].pSem = pSem;
+        sem_held[sem_held_len].since_usec = now;
+        sem_held[sem_held_len].file = file;
+        sem_held[sem_held_len].line = line;
+        sem_held_len++;
+    }
+}
+
+//!
+//! Accounts for the release of a registered semaphore, if this thread acquired it while
+//! statistics were collected.
+//!
+//! @param[in] pSem the semaphore being released
+//!
+static void sem_stats_released(sem * pSem)
+{
+    int i = 0;
+    long long max = 0;
+    long long held = 0;
+    semStats *stats = pSem->stats;
+
+    // the most recent acquisition is the likeliest to be released first
+    for (i = (sem_held_len - 1); (i >= 0) && (sem_held[i].pSem != pSem); i--) ;
+    if (i < 0)
+        return;
+
+    held = sem_stats_usec() - sem_held[i].since_usec;
+    if (sem_stats_on) {
+        __sync_fetch_and_add(&(stats->hold_usec), held);
+        __sync_fetch_and_add(&(stats->hold_hist[sem_stats_bucket(held)]), 1);
+        while (held > (max = stats->max_hold_usec)) {
+            if (__sync_bool_compare_and_swap(&(stats->max_hold_usec), max, held)) {
+                snprintf(stats->max_hold_site, sizeof(stats->max_hold_site), "%s:%d", sem_held[i].file, sem_held[i].line);
+                break;
+            }
+        }
+    }
+    sem_held[i] = sem_held[--sem_held_len];
+}
+
+//!
+//! Registers a semaphore for usage statistics, which are kept while collection is turned on
+//! with sem_stats_collect() and can be read with sem_stats_get(). Only the waits and holds
+//! of the current process are accounted, and holds only when the thread that acquired the
+//! semaphore releases it.
+//!
+//! @param[in] pSem a pointer to the semaphore
+//! @param[in] label what the semaphore guards, as shown in the statistics (e.g. "inst_sem")
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the semaphore cannot be registered
+//!
+int sem_stats_register(sem * pSem, const char *label)
+{
+    int ret = EUCA_ERROR;
+    semStats *stats = NULL;
+
+    if ((pSem == NULL) || (label == NULL) || (pSem->stats != NULL))
+        return (EUCA_ERROR);
+
+    if ((stats = EUCA_ZALLOC(1, sizeof(semStats))) == NULL)
+        return (EUCA_ERROR);
+    euca_strncpy(stats->label, label, sizeof(stats->label));
+
+    pthread_mutex_lock(&sem_stats_mutex);
+    if (sem_stats_len < SEM_STATS_MAX) {
+        sem_stats_registry[sem_stats_len++] = stats;
+        pSem->stats = stats;
+        ret = EUCA_OK;
+    }
+    pthread_mutex_unlock(&sem_stats_mutex);
+
+    if (ret != EUCA_OK)
+        EUCA_FREE(stats);
+    return (ret);
+}
+
+//!
+//! Turns the collection of semaphore statistics on or off. Turning it on resets the statistics.
+//!
+//! @param[in] enable set to TRUE to collect statistics
+//!
+void sem_stats_collect(boolean enable)
+{
+    char label[sizeof(((semStats *) NULL)->label)] = "";
+
+    pthread_mutex_lock(&sem_stats_mutex);
+    if (enable && !sem_stats_on) {
+        for (int i = 0; i < sem_stats_len; i++) {
+            euca_strncpy(label, sem_stats_registry[i]->label, sizeof(label));
+            bzero(sem_stats_registry[i], sizeof(semStats));
+            euca_strncpy(sem_stats_registry[i]->label, label, sizeof(sem_stats_registry[i]->label));
+        }
+    }
+    sem_stats_on = enable;
+    pthread_mutex_unlock(&sem_stats_mutex);
+}
+
+//!
+//! Returns a copy of the statistics of the registered semaphores
+//!
+//! @param[out] ppStats set to an array of statistics, which the caller must free
+//! @param[out] pLen set to the number of entries in the array
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if statistics are not collected or if memory
+//!         could not be allocated
+//!
+int sem_stats_get(semStats ** ppStats, int *pLen)
+{
+    int ret = EUCA_ERROR;
+
+    *ppStats = NULL;
+    *pLen = 0;
+
+    pthread_mutex_lock(&sem_stats_mutex);
+    if (sem_stats_on && (sem_stats_len > 0) && ((*ppStats = EUCA_ZALLOC(sem_stats_len, sizeof(semStats))) != NULL)) {
+        for (int i = 0; i < sem_stats_len; i++)
+            memcpy(&((*ppStats)[i]), sem_stats_registry[i], sizeof(semStats));
+        *pLen = sem_stats_len;
+        ret = EUCA_OK;
+    } else if (sem_stats_on && (sem_stats_len == 0)) {
+        ret = EUCA_OK;
+    }
+    pthread_mutex_unlock(&sem_stats_mutex);
+    return (ret);
+}
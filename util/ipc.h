@@ -94,6 +94,9 @@
 //! A mutex type semaphore uses the "mutex" type name
 #define IPC_MUTEX_SEMAPHORE                      "mutex"
 
+#define SEM_STATS_MAX                                32 //!< most semaphores whose statistics can be kept
+#define SEM_STATS_BUCKETS                             8 //!< buckets of the wait and hold time histograms: <10us, <100us, ... <10s and the rest
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -112,6 +115,19 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Usage statistics of a semaphore, kept once it is registered with sem_stats_register() and while
+//! sem_stats_collect() has collection on
+typedef struct semStats_t {
+    char label[64];                    //!< what the semaphore guards, as shown in the statistics
+    long long acquisitions;            //!< number of times the semaphore was acquired
+    long long wait_usec;               //!< total time spent waiting to acquire it
+    long long hold_usec;               //!< total time it was held, by the threads that acquired and released it
+    long long wait_hist[SEM_STATS_BUCKETS]; //!< number of acquisitions by time waited, by powers of 10 microseconds
+    long long hold_hist[SEM_STATS_BUCKETS]; //!< number of holds by duration, by powers of 10 microseconds
+    long long max_hold_usec;           //!< the longest hold
+    char max_hold_site[128];           //!< file:line where the longest hold started
+} semStats;
+
 //! Semaphore structure
 typedef struct sem_struct {
     int sysv;                          // reference to the SYS V semaphore
@@ -123,6 +139,7 @@ typedef struct sem_struct {
     int mutcount;                      // the current mutex count
     char *name;                        // the name of the semaphore
     u32 flags;                         // the kernel flags for SYS V semaphores
+    semStats *stats;                   // the usage statistics, if registered with sem_stats_register()
 } sem;
 
 #include "misc.h"                      // MUST be after this structure for boolean inclusion
@@ -148,9 +165,8 @@ void sem_free(sem * pSem);
 //! @}
 
 //! @{
-//! @name Semaphore acquisition APIs
-int sem_prolaag(sem * pSem, boolean doLog);
-int sem_p(sem * pSem);
+//! @name Semaphore acquisition APIs, see sem_prolaag() and sem_p() below
+int sem_prolaag_at(sem * pSem, boolean doLog, const char *file, int line);
 //! @}
 
 //! @{
@@ -159,6 +175,13 @@ int sem_verhogen(sem * pSem, boolean doLog);
 int sem_v(sem * pSem);
 //! @}
 
+//! @{
+//! @name Semaphore statistics APIs
+int sem_stats_register(sem * pSem, const char *label);
+void sem_stats_collect(boolean enable);
+int sem_stats_get(semStats ** ppStats, int *pLen);
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                           STATIC INLINE PROTOTYPES                         |
@@ -171,6 +194,12 @@ int sem_v(sem * pSem);
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Semaphore increment (aka lock acquisition), recording the call site for the statistics
+#define sem_prolaag(_pSem, _doLog)               sem_prolaag_at((_pSem), (_doLog), __FILE__, __LINE__)
+
+//! The semaphore increment (aka lock acquisition) used throughout
+#define sem_p(_pSem)                             sem_prolaag_at((_pSem), TRUE, __FILE__, __LINE__)
+
 //! A safe macro to free a semaphore. Force the semaphore to NULL after free.
 #define SEM_FREE(_sem)  \
 {                       \
@@ -88,6 +88,14 @@
 #include <sys/resource.h>              // rusage
 #include <execinfo.h>                  // backtrace
 #include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/uio.h>                   // writev
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>                     // O_EXCL
+#include <limits.h>                    // LONG_MAX
 #define SYSLOG_NAMES                   // we want facilities as strings
 #include <syslog.h>
 
@@ -109,6 +117,33 @@
 #define LOGFH_DEFAULT                            stdout //!< without a file, this is where log output goes
 #define USE_STANDARD_PREFIX                      "(standard)"   //!< a special string that means no custom prefix
 
+#define LOG_PREFIX_MAX_OPS                           34 //!< most steps in a compiled prefix, enough for the longest custom prefix
+#define LOG_PREFIX_MAX_LITERAL                       34 //!< most characters in a literal step of a compiled prefix
+
+#define LOG_ASYNC_SLOTS                            8192 //!< slots in the ring of the asynchronous log, must be a power of 2
+#define LOG_ASYNC_SLOT_SIZE                         256 //!< bytes of a line held by a slot, longer lines take consecutive slots
+#define LOG_ASYNC_MAX_SLOTS                          64 //!< lines needing more slots than this are written synchronously
+#define LOG_ASYNC_BATCH                             128 //!< most lines written by the writer thread with one writev()
+#define LOG_ASYNC_IDLE_USEC                      100000 //!< how long an idle writer thread sleeps before it checks the ring again
+#define LOG_ASYNC_BLOCK_USEC                       1000 //!< how long a logging thread waits for room in a full ring, with the 'block' policy
+#define LOG_ASYNC_FLUSH_USEC                    1000000 //!< how long a flush waits for the writer thread to finish the batch it writes
+
+#ifdef _BENCHMARK
+#define BENCH_DEFAULT_LEVELS                     "EXTREME,TRACE,DEBUG,INFO,WARN,ERROR"
+#define BENCH_DEFAULT_MODES                      "sync,block,drop"
+#define BENCH_DEFAULT_PROCESSES                  "1,4"
+#define BENCH_DEFAULT_THREADS                    "1,8"
+#define BENCH_DEFAULT_ROTATIONS                  "0,1048576"
+#define BENCH_DEFAULT_LINES                       20000 //!< lines logged by every thread of a run
+#define BENCH_DEFAULT_LINE_BYTES                    100 //!< length of a message, without the prefix
+#define BENCH_MESSAGE_BYTES                          40 //!< length of a message without its padding
+#define BENCH_MAX_PAD                              4096
+#define BENCH_MAX_LIST                               16
+#define BENCH_MAX_PROCESSES                          64
+#define BENCH_MAX_THREADS                           256
+#define BENCH_ROLL_NUMBER                            10 //!< files the log rotates into, as by default
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -121,12 +156,46 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! What is done with log lines, set by log_async_set()
+typedef enum log_async_mode_e {
+    LOG_ASYNC_OFF = 0,                 //!< lines are written by the logging threads, under log_sem
+    LOG_ASYNC_DROP,                    //!< lines are queued to the writer thread and dropped when the ring is full
+    LOG_ASYNC_BLOCK,                   //!< lines are queued to the writer thread, which logging threads wait for when the ring is full
+} log_async_mode;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A step of a compiled log prefix: either literal text or one of the fields of the prefix format
+typedef struct log_prefix_op_t {
+    char field;                        //!< the field character of the format (e.g., 'T' or 'm') or '\0' for literal text
+    int width;                         //!< width of the field, 0 for the length of the value (at most MAX_FIELD_LENGTH)
+    boolean left_justify;              //!< whether the field is left-justified, and truncated on the right
+    char literal[LOG_PREFIX_MAX_LITERAL];  //!< the text of a literal step
+} log_prefix_op;
+
+//! A log prefix format, compiled by log_prefix_compile() so that lines are not formatted by parsing it
+typedef struct log_prefix_prog_t {
+    int len;                           //!< number of steps
+    log_prefix_op ops[LOG_PREFIX_MAX_OPS];  //!< the steps
+} log_prefix_prog;
+
+#ifdef _BENCHMARK
+//! Thread of a benchmark run
+typedef struct bench_caller_t {
+    pthread_t thread;
+    boolean started;
+    int id;                            //!< number of the thread among those of all processes
+    int level;                         //!< level of its lines
+    int lines;                         //!< number of lines to log
+    int pad;                           //!< length of the padding of its lines
+    long long *usec;                   //!< latency of every call, in memory shared with the parent process
+} bench_caller;
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -157,6 +226,7 @@ const char *log_level_names[] = {
 //!
 //! prefix format
 //! %T = timestamp
+//! %U = timestamp with microseconds
 //! %L = loglevel
 //! %p = PID
 //! %t = thread id (same as PID in CC)
@@ -215,10 +285,49 @@ static long log_max_size_bytes = MAXLOGFILESIZE;
 static char log_file_path[EUCA_MAX_PATH] = "";
 static char log_file_path_req_track[EUCA_MAX_PATH] = "";
 static char log_custom_prefix[34] = USE_STANDARD_PREFIX;    //!< any other string means use it as custom prefix
+static log_prefix_prog log_custom_progs[2];    //!< the compiled custom prefix, in the entry at log_custom_prog_idx
+static volatile int log_custom_prog_idx = -1;   //!< which of log_custom_progs is current, -1 for the standard prefixes
 static sem *log_sem = NULL;            //!< if set, the semaphore will be used when logging & rotating logs
 static int syslog_facility = -1;       //!< if not -1 then we are logging to a syslog facility
+static volatile log_async_mode log_async = LOG_ASYNC_OFF;   //!< whether lines go to the writer thread
+//! @}
+
+//! @{
+//! @name the compiled standard prefixes and the values cached by each thread for formatting prefixes
+static log_prefix_prog log_standard_progs[EUCA_LOG_OFF + 1];  //!< log_level_prefix, compiled
+static pthread_once_t log_init_once = PTHREAD_ONCE_INIT;    //!< for log_init()
+static volatile int log_fork_generation = 0;    //!< bumped in forked children, which must not use the IDs cached by their parent
+static __thread time_t log_ts_sec = -1;    //!< the second of the timestamp in log_ts
+static __thread char log_ts[32] = "";  //!< the timestamp of log_ts_sec, as formatted by fill_timestamp()
+static __thread int log_ts_len = 0;    //!< length of log_ts
+static __thread int log_ids_generation = -1;    //!< log_fork_generation when the IDs below were cached
+static __thread char log_pid_str[11] = ""; //!< the process ID, formatted for the '%p' field
+static __thread char log_tid_str[21] = ""; //!< the thread ID, formatted for the '%t' field
 //! @}
 
+//! @{
+//! @name the ring of the asynchronous log: a bounded multi-producer queue where slot i of lap n is free
+//! while log_ring_seq[i] is (n * LOG_ASYNC_SLOTS + i) and holds a line once it is one more than that
+static volatile long long log_ring_seq[LOG_ASYNC_SLOTS];    //!< sequence numbers of the slots
+static int log_ring_len[LOG_ASYNC_SLOTS];  //!< length of the line starting at a slot
+static boolean log_ring_req[LOG_ASYNC_SLOTS];   //!< TRUE if the line starting at a slot goes to the request tracking log
+static char (*log_ring_data)[LOG_ASYNC_SLOT_SIZE] = NULL;   //!< the lines, allocated when asynchronous logging is first enabled
+static volatile long long log_enqueue_pos = 0;  //!< next slot to be taken by a logging thread
+static volatile long long log_dequeue_pos = 0;  //!< next slot to be written out
+static volatile int log_draining = 0;  //!< set while the ring is being written out, by the writer thread or a flush
+static volatile int log_writer_idle = 0;    //!< set while the writer thread sleeps and should be woken up
+static volatile long log_async_dropped = 0; //!< number of lines dropped because the ring was full
+static boolean log_writer_started = FALSE;  //!< whether the writer thread of this process runs
+static sem_t log_writer_sem;           //!< posted to wake up the writer thread
+static pthread_mutex_t log_writer_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< serializes the start of the writer thread
+//! @}
+
+#ifdef _BENCHMARK
+static char bench_pad[BENCH_MAX_PAD + 1] = "";  //!< padding of the benchmark lines
+static sem *bench_mutex_sem = NULL;    //!< log_sem of single-process runs, as in the NC
+static sem *bench_posix_sem = NULL;    //!< log_sem of multi-process runs, as in the CC
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -229,8 +338,34 @@ static FILE *get_file_impl(const char *log_file, FILE * fp, ino_t * log_inop, bo
 static void release_file(const char *log_file);
 
 static int fill_timestamp(char *buf, int buf_size);
+static int fill_timestamp_usec(char *buf, int buf_size);
+static void log_init(void);
+static void log_atfork_child(void);
+static void log_prefix_compile(const char *spec, log_prefix_prog * prog);
+static int log_prefix_field(const log_prefix_op * op, char *buf, int left, const char *field);
+static int log_prefix_format(const log_prefix_prog * prog, char *buf, int buf_size, const char *func, const char *file, int line, log_level_e level);
 static int log_line(const char *log_file, const char *line);
-static int print_field_truncated(const char **log_spec, char *buf, int left, const char *field);
+static void log_ring_reset(void);
+static void log_async_fatal_handler(int sig);
+static void log_async_atexit(void);
+static int log_async_start(void);
+static int log_async_push(const char *log_file, const char *line);
+static int log_async_write(boolean in_signal);
+static void *log_writer_thread(void *arg);
+
+#ifdef _BENCHMARK
+static long long bench_usec(void);
+static int bench_compare(const void *a, const void *b);
+static void bench_report(FILE * out, const char *op, const char *config, int threads, long long *usec, int len, long long elapsed_usec, const char *extra);
+static int bench_split(char *list, char **items, int size);
+static void bench_clean(const char *path);
+static long long bench_count_lines(const char *path, int *files);
+static void *bench_caller_thread(void *arg);
+static int bench_process(int level, int first, int threads, int lines, int pad, long long *usec);
+static int bench_run(FILE * out, const char *phase, const char *path, int level, int threshold, const char *mode, int processes, int threads, long rotate_bytes,
+                     int lines, int line_bytes);
+static int do_benchmark(int argc, char **argv);
+#endif /* _BENCHMARK */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -542,11 +677,29 @@ int log_file_set(const char *file, const char *req_track_file)
 //!
 int log_prefix_set(const char *log_spec)
 {
+    int idx = 0;
+    char spec[sizeof(log_custom_prefix)] = "";
+
     // @todo eventually, enable empty prefix
     if ((log_spec == NULL) || (strlen(log_spec) == 0))
-        euca_strncpy(log_custom_prefix, USE_STANDARD_PREFIX, sizeof(log_custom_prefix));
+        euca_strncpy(spec, USE_STANDARD_PREFIX, sizeof(spec));
     else
-        euca_strncpy(log_custom_prefix, log_spec, sizeof(log_custom_prefix));
+        euca_strncpy(spec, log_spec, sizeof(spec));
+
+    // the CC sets the prefix on every request, so only a change is compiled
+    if (!strcmp(spec, log_custom_prefix))
+        return (EUCA_OK);
+    euca_strncpy(log_custom_prefix, spec, sizeof(log_custom_prefix));
+
+    if (!strcmp(spec, USE_STANDARD_PREFIX)) {
+        log_custom_prog_idx = -1;
+    } else {
+        // compile into the entry not in use, so that lines being logged keep a consistent prefix
+        idx = ((log_custom_prog_idx == 0) ? 1 : 0);
+        log_prefix_compile(spec, &log_custom_progs[idx]);
+        __sync_synchronize();
+        log_custom_prog_idx = idx;
+    }
     return (EUCA_OK);
 }
 
@@ -623,11 +776,11 @@ int log_sem_set(sem * pSem)
 
     if (log_sem != NULL) {
         old_log_sem = log_sem;
-        sem_p(old_log_sem);
+        sem_prolaag(old_log_sem, FALSE);   // a logged acquisition would wait on this very semaphore
         if (log_sem != pSem) {
             log_sem = pSem;
         }
-        sem_v(old_log_sem);
+        sem_verhogen(old_log_sem, FALSE);
     } else {
         log_sem = pSem;
     }
@@ -676,8 +829,51 @@ static int fill_timestamp(char *buf, int buf_size)
     time_t t = time(NULL);
     struct tm tm = { 0 };
 
-    localtime_r(&t, &tm);
-    return (strftime(buf, buf_size, "%F %T", &tm));
+    // the conversion is only redone once a second, by each thread
+    if (t != log_ts_sec) {
+        localtime_r(&t, &tm);
+        log_ts_len = strftime(log_ts, sizeof(log_ts), "%F %T", &tm);
+        log_ts_sec = t;
+    }
+
+    if ((log_ts_len == 0) || (log_ts_len >= buf_size))
+        return (0);
+    memcpy(buf, log_ts, (log_ts_len + 1));
+    return (log_ts_len);
+}
+
+//!
+//! Print timestamp in YYYY-MM-DD HH:MM:SS.UUUUUU format.
+//!
+//! @param[in,out] buf the string buffer to contain the formatted timestamp
+//! @param[in]     buf_size the size of the given buffer
+//!
+//! @return the number of characters that it took up or 0 on error.
+//!
+//! @see fill_timestamp()
+//!
+static int fill_timestamp_usec(char *buf, int buf_size)
+{
+    long usec = 0;
+    struct timeval tv = { 0 };
+    struct tm tm = { 0 };
+
+    gettimeofday(&tv, NULL);
+    usec = tv.tv_usec;
+    if (tv.tv_sec != log_ts_sec) {
+        localtime_r(&(tv.tv_sec), &tm);
+        log_ts_len = strftime(log_ts, sizeof(log_ts), "%F %T", &tm);
+        log_ts_sec = tv.tv_sec;
+    }
+
+    if ((log_ts_len == 0) || ((log_ts_len + 7) >= buf_size))
+        return (0);
+    memcpy(buf, log_ts, log_ts_len);
+    buf[log_ts_len] = '.';
+    for (int i = 6; i > 0; i--, usec /= 10)
+        buf[log_ts_len + i] = '0' + (usec % 10);
+    buf[log_ts_len + 7] = '\0';
+    return (log_ts_len + 7);
 }
 
 //!
@@ -696,6 +892,10 @@ static int log_line(const char *log_file, const char *line)
     int rc = EUCA_ERROR;
     FILE *pFh = NULL;
 
+    // with asynchronous logging, the writer thread takes care of the line
+    if (log_async_push(log_file, line) == EUCA_OK)
+        return (EUCA_OK);
+
     if (log_sem) {
         sem_prolaag(log_sem, FALSE);
 
@@ -719,6 +919,375 @@ static int log_line(const char *log_file, const char *line)
     return (rc);
 }
 
+//!
+//! Sets the ring of the asynchronous log to empty.
+//!
+static void log_ring_reset(void)
+{
+    for (int i = 0; i < LOG_ASYNC_SLOTS; i++)
+        log_ring_seq[i] = i;
+    log_enqueue_pos = 0;
+    log_dequeue_pos = 0;
+    log_draining = 0;
+    log_writer_idle = 0;
+}
+
+//!
+//! In a forked child, forgets the process and thread IDs cached by the parent and the lines
+//! queued by the parent, which threads that do not exist in the child may have been writing,
+//! and lets the child start its own writer thread.
+//!
+static void log_atfork_child(void)
+{
+    log_fork_generation++;
+    pthread_mutex_init(&log_writer_mutex, NULL);
+    if (log_writer_started) {
+        log_writer_started = FALSE;
+        log_ring_reset();
+    }
+}
+
+//!
+//! Writes out the queued lines when the process crashes, then lets the signal take its
+//! default action.
+//!
+//! @param[in] sig the signal received
+//!
+static void log_async_fatal_handler(int sig)
+{
+    log_async_flush(TRUE);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+//!
+//! Writes out the queued lines when the process exits.
+//!
+static void log_async_atexit(void)
+{
+    log_async_flush(FALSE);
+}
+
+//!
+//! Starts the writer thread of this process, unless it runs already. The first start also
+//! installs the handlers that write out the queued lines on exit and on fatal signals, for
+//! those signals the process does not handle itself.
+//!
+//! @return EUCA_OK if the writer thread runs or EUCA_ERROR otherwise
+//!
+static int log_async_start(void)
+{
+    static boolean handlers_set = FALSE;
+    int ret = EUCA_OK;
+    int fatal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+    pthread_t tid;
+    pthread_attr_t tattr;
+    struct sigaction sa = { {0} };
+    struct sigaction old = { {0} };
+
+    pthread_once(&log_init_once, log_init);
+
+    pthread_mutex_lock(&log_writer_mutex);
+    if (!log_writer_started) {
+        if (!handlers_set) {
+            sem_init(&log_writer_sem, 0, 0);
+            log_ring_reset();
+            atexit(log_async_atexit);
+
+            sa.sa_handler = log_async_fatal_handler;
+            sa.sa_flags = SA_RESETHAND;
+            sigemptyset(&sa.sa_mask);
+            for (int i = 0; i < (sizeof(fatal_signals) / sizeof(fatal_signals[0])); i++) {
+                if ((sigaction(fatal_signals[i], NULL, &old) == 0) && (old.sa_handler == SIG_DFL)) {
+                    sigaction(fatal_signals[i], &sa, NULL);
+                }
+            }
+            handlers_set = TRUE;
+        }
+
+        pthread_attr_init(&tattr);
+        pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&tid, &tattr, log_writer_thread, NULL) == 0) {
+            log_writer_started = TRUE;
+        } else {
+            ret = EUCA_ERROR;
+        }
+        pthread_attr_destroy(&tattr);
+    }
+    pthread_mutex_unlock(&log_writer_mutex);
+    return (ret);
+}
+
+//!
+//! Queues a line for the writer thread. A line takes one or more consecutive slots of the
+//! ring, which are claimed with a single compare-and-swap, so logging threads never wait on
+//! each other or on the writer. When the ring is full, the line is dropped or the thread waits
+//! for room, depending on the policy set by log_async_set().
+//!
+//! @param[in] log_file the log the line goes to, either log_file_path or log_file_path_req_track
+//! @param[in] line the line to log
+//!
+//! @return EUCA_OK if the line was queued or dropped by policy, or EUCA_ERROR if the caller
+//!         must write it: asynchronous logging is off, the log is not a file we own or the
+//!         line is too long for the ring.
+//!
+static int log_async_push(const char *log_file, const char *line)
+{
+    int i = 0;
+    int len = 0;
+    int slots = 0;
+    int chunk = 0;
+    long long pos = 0;
+    long long diff = 0;
+    boolean req = FALSE;
+
+    if ((log_async == LOG_ASYNC_OFF) || (log_ring_data == NULL) || (log_max_size_bytes == 0) || (log_file[0] == '\0'))
+        return (EUCA_ERROR);
+
+    if (!strcmp(log_file, log_file_path)) {
+        req = FALSE;
+    } else if (!strcmp(log_file, log_file_path_req_track)) {
+        req = TRUE;
+    } else {
+        return (EUCA_ERROR);
+    }
+
+    len = strlen(line);
+    if ((len == 0) || ((slots = ((len + LOG_ASYNC_SLOT_SIZE - 1) / LOG_ASYNC_SLOT_SIZE)) > LOG_ASYNC_MAX_SLOTS))
+        return (EUCA_ERROR);
+
+    if (!log_writer_started && (log_async_start() != EUCA_OK))
+        return (EUCA_ERROR);
+
+    for (;;) {
+        pos = log_enqueue_pos;
+        for (i = 0, diff = 0; (i < slots) && ((diff = (log_ring_seq[(pos + i) & (LOG_ASYNC_SLOTS - 1)] - (pos + i))) == 0); i++) ;
+        if (i == slots) {
+            // all the slots are free, try to claim them
+            if (__sync_bool_compare_and_swap(&log_enqueue_pos, pos, (pos + slots)))
+                break;
+        } else if (diff < 0) {
+            // the ring is full
+            if (log_async == LOG_ASYNC_DROP) {
+                __sync_fetch_and_add(&log_async_dropped, 1);
+                return (EUCA_OK);
+            }
+            if (log_writer_idle)
+                sem_post(&log_writer_sem);
+            usleep(LOG_ASYNC_BLOCK_USEC);
+        }
+        // else another thread claimed the slots first, try again at the new position
+    }
+
+    for (i = 0; i < slots; i++) {
+        chunk = (((len - i * LOG_ASYNC_SLOT_SIZE) < LOG_ASYNC_SLOT_SIZE) ? (len - i * LOG_ASYNC_SLOT_SIZE) : LOG_ASYNC_SLOT_SIZE);
+        memcpy(log_ring_data[(pos + i) & (LOG_ASYNC_SLOTS - 1)], line + (i * LOG_ASYNC_SLOT_SIZE), chunk);
+    }
+    log_ring_len[pos & (LOG_ASYNC_SLOTS - 1)] = len;
+    log_ring_req[pos & (LOG_ASYNC_SLOTS - 1)] = req;
+
+    // publish the slots, the first one last since the writer looks at it to find the line
+    __sync_synchronize();
+    for (i = (slots - 1); i >= 0; i--) {
+        log_ring_seq[(pos + i) & (LOG_ASYNC_SLOTS - 1)] = (pos + i + 1);
+        __sync_synchronize();
+    }
+
+    if (log_writer_idle)
+        sem_post(&log_writer_sem);
+    return (EUCA_OK);
+}
+
+//!
+//! Writes out a batch of queued lines: up to LOG_ASYNC_BATCH consecutive lines going to the
+//! same log, with one writev() under a single hold of log_sem, which is when the log is also
+//! checked for rotation. Only one thread at a time may call this, see log_draining.
+//!
+//! @param[in] in_signal set to TRUE when called from a signal handler, in which case the lines
+//!                      go to the log as it is open, without log_sem or rotation
+//!
+//! @return the number of lines written out
+//!
+static int log_async_write(boolean in_signal)
+{
+    int i = 0;
+    int n = 0;
+    int fd = -1;
+    int idx = 0;
+    int iovcnt = 0;
+    int first = 0;
+    int slots = 0;
+    long long pos = 0;
+    long long end = 0;
+    boolean req = FALSE;
+    const char *log_file = NULL;
+    FILE *pFh = NULL;
+    struct iovec iov[LOG_ASYNC_BATCH * 2] = { {0} };
+
+    pos = end = log_dequeue_pos;
+    while ((n < LOG_ASYNC_BATCH) && (log_ring_seq[(idx = (end & (LOG_ASYNC_SLOTS - 1)))] == (end + 1))) {
+        if ((n > 0) && (log_ring_req[idx] != req))
+            break;
+        req = log_ring_req[idx];
+        slots = ((log_ring_len[idx] + LOG_ASYNC_SLOT_SIZE - 1) / LOG_ASYNC_SLOT_SIZE);
+
+        // a line may wrap around the end of the ring
+        if ((first = ((LOG_ASYNC_SLOTS - idx) * LOG_ASYNC_SLOT_SIZE)) >= log_ring_len[idx]) {
+            iov[iovcnt].iov_base = log_ring_data[idx];
+            iov[iovcnt++].iov_len = log_ring_len[idx];
+        } else {
+            iov[iovcnt].iov_base = log_ring_data[idx];
+            iov[iovcnt++].iov_len = first;
+            iov[iovcnt].iov_base = log_ring_data[0];
+            iov[iovcnt++].iov_len = (log_ring_len[idx] - first);
+        }
+        end += slots;
+        n++;
+    }
+
+    if (n == 0)
+        return (0);
+
+    log_file = ((req) ? (log_file_path_req_track) : (log_file_path));
+    if (in_signal) {
+        if ((pFh = ((req) ? (gLogFhReq) : (gLogFh))) != NULL) {
+            fflush(pFh);
+            writev(fileno(pFh), iov, iovcnt);
+        }
+    } else {
+        if (log_sem)
+            sem_prolaag(log_sem, FALSE);
+
+        if ((pFh = get_file(log_file, FALSE)) != NULL) {
+            fflush(pFh);               // in case lines were written synchronously in between
+            if ((fd = fileno(pFh)) >= 0)
+                writev(fd, iov, iovcnt);
+            release_file(log_file);
+        }
+
+        if (log_sem)
+            sem_verhogen(log_sem, FALSE);
+    }
+
+    // hand the slots back to the logging threads, for their next lap
+    __sync_synchronize();
+    for (i = 0; pos + i < end; i++)
+        log_ring_seq[(pos + i) & (LOG_ASYNC_SLOTS - 1)] = (pos + i + LOG_ASYNC_SLOTS);
+    log_dequeue_pos = end;
+    return (n);
+}
+
+//!
+//! The writer thread of the asynchronous log, which writes out the queued lines in batches
+//! and reports the lines dropped because the ring was full.
+//!
+//! @param[in] arg unused
+//!
+//! @return Always return NULL
+//!
+static void *log_writer_thread(void *arg)
+{
+    int n = 0;
+    long dropped = 0;
+    char buf[256] = "";
+    struct timespec ts = { 0 };
+
+    for (;;) {
+        n = 0;
+        if (__sync_lock_test_and_set(&log_draining, 1) == 0) {
+            while ((n = log_async_write(FALSE)) == LOG_ASYNC_BATCH) ;
+            __sync_lock_release(&log_draining);
+        }
+
+        if ((dropped = __sync_lock_test_and_set(&log_async_dropped, 0)) > 0) {
+            n = fill_timestamp(buf, sizeof(buf));
+            snprintf(buf + n, sizeof(buf) - n, "  WARN | dropped %ld log lines because the log could not keep up\n", dropped);
+            log_line(log_file_path, buf);
+        }
+
+        // sleep unless lines arrived meanwhile
+        log_writer_idle = 1;
+        __sync_synchronize();
+        if (log_ring_seq[log_dequeue_pos & (LOG_ASYNC_SLOTS - 1)] != (log_dequeue_pos + 1)) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (LOG_ASYNC_IDLE_USEC * 1000);
+            ts.tv_sec += (ts.tv_nsec / 1000000000);
+            ts.tv_nsec %= 1000000000;
+            sem_timedwait(&log_writer_sem, &ts);
+        }
+        log_writer_idle = 0;
+    }
+
+    return (NULL);
+}
+
+//!
+//! Sets whether log lines are written by the logging threads (the default) or queued to a
+//! writer thread, which lets logging threads go on without waiting on the log semaphore or
+//! the disk, and which writes the lines out in batches. Lines longer than the ring allows,
+//! lines going to stdout or a file set with log_fp_set() and syslog are not affected.
+//!
+//! @param[in] policy "drop" or "block" for asynchronous logging, which either drops lines or
+//!                   waits for the writer thread when the ring is full, or NULL, "" or "N"
+//!                   for synchronous logging
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on an unknown policy or a failure to allocate
+//!         the ring
+//!
+int log_async_set(const char *policy)
+{
+    log_async_mode mode = LOG_ASYNC_OFF;
+
+    if ((policy == NULL) || (policy[0] == '\0') || !strcasecmp(policy, "N") || !strcasecmp(policy, "no")) {
+        mode = LOG_ASYNC_OFF;
+    } else if (!strcasecmp(policy, "drop")) {
+        mode = LOG_ASYNC_DROP;
+    } else if (!strcasecmp(policy, "block")) {
+        mode = LOG_ASYNC_BLOCK;
+    } else {
+        LOGERROR("unrecognized asynchronous logging policy '%s' requested, ignoring\n", policy);
+        return (EUCA_ERROR);
+    }
+
+    if ((mode != LOG_ASYNC_OFF) && (log_ring_data == NULL)) {
+        pthread_mutex_lock(&log_writer_mutex);
+        if (log_ring_data == NULL)
+            log_ring_data = EUCA_ZALLOC(LOG_ASYNC_SLOTS, LOG_ASYNC_SLOT_SIZE);
+        pthread_mutex_unlock(&log_writer_mutex);
+        if (log_ring_data == NULL)
+            return (EUCA_ERROR);
+    }
+
+    if (mode != log_async) {
+        log_async = mode;
+        LOGINFO("logging %s\n", ((mode == LOG_ASYNC_OFF) ? "synchronously" : ((mode == LOG_ASYNC_DROP) ? "asynchronously, dropping lines when behind" : "asynchronously")));
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Writes out all the lines queued for the writer thread, such as before the process exits.
+//!
+//! @param[in] in_signal set to TRUE when called from a signal handler
+//!
+void log_async_flush(boolean in_signal)
+{
+    int waited = 0;
+
+    if (!log_writer_started)
+        return;
+
+    // wait for the writer thread to finish the batch it may be writing
+    while (__sync_lock_test_and_set(&log_draining, 1) != 0) {
+        if ((waited += 1000) > LOG_ASYNC_FLUSH_USEC)
+            return;
+        usleep(1000);
+    }
+
+    while (log_async_write(in_signal) > 0) ;
+    __sync_lock_release(&log_draining);
+}
+
 //!
 //! Log-printing function without a specific log level. It is essentially printf() that will go verbatim,
 //! with just timestamp as prefix and at any log level, into the current log or stdout, if no log was open.
@@ -736,7 +1305,7 @@ int logprintf(const char *format, ...)
 {
     int rc = -1;
     int offset = -1;
-    char buf[LOGLINEBUF] = "";
+    char buf[LOGLINEBUF];              // not initialized, it is large and everything written to it is terminated
     va_list ap = { {0} };
 
     // start with current timestamp
@@ -755,69 +1324,242 @@ int logprintf(const char *format, ...)
 }
 
 //!
+//! Compiles the standard prefixes and sets up the handling of forks, once per process.
 //!
+static void log_init(void)
+{
+    for (int i = 0; i <= EUCA_LOG_OFF; i++)
+        log_prefix_compile(log_level_prefix[i], &log_standard_progs[i]);
+    pthread_atfork(NULL, NULL, log_atfork_child);
+}
+
 //!
-//! @param[in] log_spec
-//! @param[in] buf
-//! @param[in] left
-//! @param[in] field
+//! Compiles a prefix format (see log_level_prefix) into the steps that log_prefix_format()
+//! goes through for each line, so that the format is only parsed when it is set.
 //!
-//! @return the number of bytes written in our string buffer 'buf'
+//! @param[in]  spec the prefix format
+//! @param[out] prog the compiled prefix
 //!
-static int print_field_truncated(const char **log_spec, char *buf, int left, const char *field)
+static void log_prefix_compile(const char *spec, log_prefix_prog * prog)
 {
     int i = 0;
-    int offset = 0;
-    int in_field_len = strlen(field);
-    int out_field_len = MAX_FIELD_LENGTH;
+    int len = 0;
+    char c = '\0';
+    char cn = '\0';
     char *nend = NULL;
-    char format[10] = "";
-    boolean left_justify = FALSE;
     const char *nstart = NULL;
+    log_prefix_op *op = NULL;
 
-    if (in_field_len < out_field_len) {
-        // unless specified, we'll use length of the field or max
-        out_field_len = in_field_len;
-    }
-    // first, look ahead down s[] to see if we have length  and alignment specified (leading '-' means left-justified)
-    nstart = (*log_spec) + 1;
-    if (*nstart == '-') {
-        // a leading zero
-        left_justify = TRUE;
-        nstart++;
-    }
-
-    i = (int)strtoll(nstart, &nend, 10);
-    if (nstart != nend) {
-        // we have some digits, move the pointer ahead so caller will skip digits
-        *log_spec = nend - 1;
-        // sanity check
-        if ((i > 1) && (i < 100)) {
-            out_field_len = i;
+    bzero(prog, sizeof(log_prefix_prog));
+    for (; (*spec != '\0') && (prog->len < LOG_PREFIX_MAX_OPS); spec++) {
+        // see if we have a formatting character or a regular one
+        c = spec[0];
+        cn = spec[1];
+        if ((c != '%')                 // not a special formatting char
+            || (c == '%' && cn == '%') // formatting char, escaped
+            || (c == '%' && cn == '\0')) {  // formatting char at the end
+            if ((c == '%') && (cn == '%')) {
+                // swallow the one extra '%' in input
+                spec++;
+            }
+            // append to the literal step in progress, if any
+            op = ((prog->len > 0) ? &(prog->ops[prog->len - 1]) : NULL);
+            if ((op == NULL) || (op->field != '\0') || ((len = strlen(op->literal)) >= (LOG_PREFIX_MAX_LITERAL - 1))) {
+                op = &(prog->ops[prog->len++]);
+                len = 0;
+            }
+            op->literal[len] = c;
+            op->literal[len + 1] = '\0';
+            continue;
+        }
+        // move past the '%' to the formatting char
+        spec++;
+        op = &(prog->ops[prog->len++]);
+        op->field = *spec;
+
+        switch (op->field) {
+        case 'p':
+        case 't':
+        case 'm':
+        case 'F':
+        case 's':
+            // look ahead to see if we have length and alignment specified (leading '-' means left-justified)
+            nstart = spec + 1;
+            if (*nstart == '-') {
+                op->left_justify = TRUE;
+                nstart++;
+            }
+
+            i = (int)strtoll(nstart, &nend, 10);
+            if (nstart != nend) {
+                // we have some digits, skip them
+                spec = nend - 1;
+                // sanity check
+                if ((i > 1) && (i < 100)) {
+                    op->width = i;
+                }
+            }
+            break;
+
+        case 'T':
+        case 'U':
+        case 'L':
+            break;
+
+        case '?':
+            // not supported currently
+        default:
+            // the character itself is printed
+            op->literal[0] = op->field;
+            op->literal[1] = '\0';
+            op->field = '\0';
+            break;
         }
     }
-    // create a format string that would truncate the field to len and then print the field into 's'
+}
+
+//!
+//! Prints a field of a prefix, padded or truncated as its step says: to the field's width or,
+//! without one, to the length of the value, up to MAX_FIELD_LENGTH. Right-justified fields
+//! are truncated on the left.
+//!
+//! @param[in] op the step of the field
+//! @param[in] buf the buffer to print into
+//! @param[in] left the room left in buf
+//! @param[in] field the value of the field
+//!
+//! @return the number of bytes written in buf or -1 if there is not enough room
+//!
+static int log_prefix_field(const log_prefix_op * op, char *buf, int left, const char *field)
+{
+    int offset = 0;
+    int in_field_len = strlen(field);
+    int out_field_len = op->width;
+
+    if (out_field_len == 0)
+        out_field_len = ((in_field_len < MAX_FIELD_LENGTH) ? in_field_len : MAX_FIELD_LENGTH);
+
     if (left < (out_field_len + 1)) {
         // not enough room left
         return -1;
     }
-    // when right-justifying, we want to truncate the field on the left (when left-justifying the
-    // snprintf below will truncate on the right)
-    if (left_justify == FALSE) {
-        offset = in_field_len - out_field_len;
-        if (offset < 0)
-            offset = 0;
-    }
 
-    snprintf(format, sizeof(format), "%%%s%ds", (left_justify) ? "-" : "", out_field_len);
-    if (snprintf(buf, (out_field_len + 1), format, field + offset) < out_field_len) {
-        // error in snprintf
-        return -1;
+    if (in_field_len >= out_field_len) {
+        // when right-justifying, we want to truncate the field on the left
+        offset = ((op->left_justify) ? 0 : (in_field_len - out_field_len));
+        memcpy(buf, field + offset, out_field_len);
+    } else if (op->left_justify) {
+        memcpy(buf, field, in_field_len);
+        memset(buf + in_field_len, ' ', (out_field_len - in_field_len));
+    } else {
+        memset(buf, ' ', (out_field_len - in_field_len));
+        memcpy(buf + (out_field_len - in_field_len), field, in_field_len);
     }
-
+    buf[out_field_len] = '\0';
     return (out_field_len);
 }
 
+//!
+//! Prints the prefix of a log line by going through the steps of a compiled prefix.
+//!
+//! @param[in] prog the compiled prefix
+//! @param[in] buf the buffer to print into
+//! @param[in] buf_size the size of buf
+//! @param[in] func the caller function name
+//! @param[in] file the file in which the caller function reside
+//! @param[in] line the line at which the caller logged
+//! @param[in] level the log level of the line
+//!
+//! @return the number of bytes written in buf or -1 on error
+//!
+static int log_prefix_format(const log_prefix_prog * prog, char *buf, int buf_size, const char *func, const char *file, int line, log_level_e level)
+{
+    int i = 0;
+    int size = 0;
+    int left = 0;
+    int offset = 0;
+    char *s = NULL;
+    char file_and_line[64] = "";
+    char size_str[64] = "";
+    struct rusage u = { {0} };
+    const log_prefix_op *op = NULL;
+
+    buf[0] = '\0';
+    for (i = 0; i < prog->len; i++) {
+        op = &(prog->ops[i]);
+        s = buf + offset;
+        if ((left = buf_size - offset - 1) < 1) {
+            // not enough room in internal buffer for a prefix
+            return -1;
+        }
+
+        size = 0;
+        switch (op->field) {
+        case '\0':
+            // literal text
+            if ((size = strlen(op->literal)) >= left)
+                return -1;
+            memcpy(s, op->literal, (size + 1));
+            break;
+
+        case 'T':
+            // timestamp
+            size = fill_timestamp(s, left);
+            break;
+
+        case 'U':
+            // timestamp with microseconds
+            size = fill_timestamp_usec(s, left);
+            break;
+
+        case 'L':
+            // log-level, with hard truncation
+            size = snprintf(s, left, "%5.5s", log_level_names[level]);
+            break;
+
+        case 'p':
+        case 't':
+            // process or thread ID, which are cached by each thread
+            if (log_ids_generation != log_fork_generation) {
+                snprintf(log_pid_str, sizeof(log_pid_str), "%010d", getpid()); // 10 chars is enough for max 32-bit unsigned integer
+                snprintf(log_tid_str, sizeof(log_tid_str), "%020d", (pid_t) syscall(SYS_gettid));  // 20 chars is enough for max 64-bit unsigned integer
+                log_ids_generation = log_fork_generation;
+            }
+            size = log_prefix_field(op, s, left, ((op->field == 'p') ? log_pid_str : log_tid_str));
+            break;
+
+        case 'm':
+            // method
+            size = log_prefix_field(op, s, left, func);
+            break;
+
+        case 'F':
+            // file-and-line
+            snprintf(file_and_line, sizeof(file_and_line), "%s:%d", file, line);
+            size = log_prefix_field(op, s, left, file_and_line);
+            break;
+
+        case 's':
+            // max RSS of the process
+            // unfortunately, many fields in 'struct rusage' aren't supported on Linux (notably: ru_ixrss, ru_idrss, ru_isrss)
+            getrusage(RUSAGE_SELF, &u);
+            snprintf(size_str, sizeof(size_str), "%05ld", u.ru_maxrss / 1024);
+            size = log_prefix_field(op, s, left, size_str);
+            break;
+
+        default:
+            break;
+        }
+
+        if (size < 0) {
+            // something went wrong in the formatting above
+            return -1;
+        }
+        offset += size;
+    }
+    return (offset);
+}
+
 //!
 //! Main log-printing function, which will dump a line into a log, with a prefix appropriate for
 //! the log level, given that the log level is above the threshold.
@@ -846,16 +1588,14 @@ static int print_field_truncated(const char **log_spec, char *buf, int left, con
 int logprintfl(const char *func, const char *file, int line, log_level_e level, const char *format, ...)
 {
     int rc = -1;
-    int left = 0;
-    int size = 0;
+    int idx = 0;
     int offset = 0;
     char *s = NULL;
     char c = '\0';
-    char cn = '\0';
     boolean custom_spec = FALSE;
-    char buf[LOGLINEBUF] = "";
+    char buf[LOGLINEBUF];              // not initialized, it is large and everything written to it is terminated
     va_list ap = { {0} };
-    const char *prefix_spec = NULL;
+    const log_prefix_prog *prog = NULL;
     boolean is_corrid = FALSE;
     char buf_corrid[128] = "";
 
@@ -874,116 +1614,19 @@ int logprintfl(const char *func, const char *file, int line, log_level_e level,
         is_corrid = TRUE;
     }
 
-    if (strcmp(log_custom_prefix, USE_STANDARD_PREFIX) == 0) {
-        prefix_spec = log_level_prefix[log_level];
+    pthread_once(&log_init_once, log_init);
+    if ((idx = log_custom_prog_idx) < 0) {
+        prog = &log_standard_progs[log_level];
         custom_spec = FALSE;
     } else {
-        prefix_spec = log_custom_prefix;
+        prog = &log_custom_progs[idx];
         custom_spec = TRUE;
     }
 
-    // go over prefix format for the log level (defined in log.h or custom)
-    for (; *prefix_spec != '\0'; prefix_spec++) {
-        s = buf + offset;
-        if ((left = sizeof(buf) - offset - 1) < 1) {
-            // not enough room in internal buffer for a prefix
-            return -1;
-        }
-        // see if we have a formatting character or a regular one
-        c = prefix_spec[0];
-        cn = prefix_spec[1];
-        if ((c != '%')                 // not a special formatting char
-            || (c == '%' && cn == '%') // formatting char, escaped
-            || (c == '%' && cn == '\0')) {  // formatting char at the end
-            s[0] = c;
-            s[1] = '\0';
-            offset++;
-            if ((c == '%') && (cn == '%')) {
-                // swallow the one extra '%' in input
-                prefix_spec++;
-            }
-            continue;
-        }
-        // move past the '%' to the formatting char
-        prefix_spec++;
-
-        size = 0;
-        switch (*prefix_spec) {
-        case 'T':
-            // timestamp
-            size = fill_timestamp(s, left);
-            break;
-
-        case 'L':{
-                // log-level
-                char l[6];
-                euca_strncpy(l, log_level_names[level], 6); // we want hard truncation
-                size = snprintf(s, left, "%5s", l);
-                break;
-            }
-
-        case 'p':{
-                // process ID
-                char p[11];
-                snprintf(p, sizeof(p), "%010d", getpid());  // 10 chars is enough for max 32-bit unsigned integer
-                size = print_field_truncated(&prefix_spec, s, left, p);
-                break;
-            }
-
-        case 't':{
-                // thread ID
-                char t[21];
-                snprintf(t, sizeof(t), "%020d", (pid_t) syscall(SYS_gettid));   // 20 chars is enough for max 64-bit unsigned integer
-                size = print_field_truncated(&prefix_spec, s, left, t);
-                break;
-            }
-
-        case 'm':
-            // method
-            size = print_field_truncated(&prefix_spec, s, left, func);
-            break;
-
-        case 'F':{
-                // file-and-line
-                char file_and_line[64];
-                snprintf(file_and_line, sizeof(file_and_line), "%s:%d", file, line);
-                size = print_field_truncated(&prefix_spec, s, left, file_and_line);
-                break;
-            }
-
-        case 's':{
-                // max RSS of the process
-                struct rusage u;
-                bzero(&u, sizeof(struct rusage));
-                getrusage(RUSAGE_SELF, &u);
-
-                // unfortunately, many fields in 'struct rusage' aren't supported on Linux (notably: ru_ixrss, ru_idrss, ru_isrss)
-                char size_str[64];
-                snprintf(size_str, sizeof(size_str), "%05ld", u.ru_maxrss / 1024);
-                size = print_field_truncated(&prefix_spec, s, left, size_str);
-                break;
-            }
-
-        case '?':
-            // not supported currently
-            s[0] = '?';
-            s[1] = '\0';
-            size = 1;
-            break;
-
-        default:
-            s[0] = *prefix_spec;
-            s[1] = '\0';
-            size = 1;
-            break;
-        }
-
-        if (size < 0) {
-            // something went wrong in the snprintf()s above
-            logprintf("error in prefix construction in logprintfl()\n");
-            return -1;
-        }
-        offset += size;
+    // the prefix for the log level (defined in log.h or custom), as compiled
+    if ((offset = log_prefix_format(prog, buf, sizeof(buf), func, file, line, level)) < 0) {
+        logprintf("error in prefix construction in logprintfl()\n");
+        return -1;
     }
 
     if (is_corrid && log_file_path_req_track != NULL) {
@@ -1156,3 +1799,466 @@ void log_dump_trace(char *buf, int buf_size)
 
     EUCA_FREE(strings);
 }
+
+#ifdef _BENCHMARK
+//!
+//! Microseconds on the monotonic clock
+//!
+//! @return the current time in microseconds
+//!
+static long long bench_usec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000);
+}
+
+//!
+//! qsort() comparator of latencies
+//!
+static int bench_compare(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints one result line. Every line starts with 'log_bench' and only holds key=value pairs,
+//! so results can be compared across runs with standard tools.
+//!
+//! @param[in]     out stream to print to
+//! @param[in]     op name of the operation
+//! @param[in]     config key=value pairs describing the configuration
+//! @param[in]     threads number of threads, in all processes, that made the calls
+//! @param[in,out] usec latency of every call, in microseconds (sorted by this function)
+//! @param[in]     len number of entries in usec[]
+//! @param[in]     elapsed_usec wall-clock time of the run, until every line was written out
+//! @param[in]     extra more key=value pairs about the outcome of the run
+//!
+static void bench_report(FILE * out, const char *op, const char *config, int threads, long long *usec, int len, long long elapsed_usec, const char *extra)
+{
+    long long total = 0;
+
+    if (len == 0)
+        return;
+
+    qsort(usec, len, sizeof(long long), bench_compare);
+    for (int i = 0; i < len; i++)
+        total += usec[i];
+
+#define _PCT(_F)                       (usec[MIN(len - 1, (int)((_F) * len))])
+    fprintf(out, "log_bench op=%s %s threads=%d calls=%d lines_per_sec=%.1f mean_us=%.2f p50_us=%lld p90_us=%lld p99_us=%lld p999_us=%lld max_us=%lld %s\n",
+            op, config, threads, len, ((elapsed_usec > 0) ? (len * 1000000.0 / elapsed_usec) : 0.0), ((double)total / len), _PCT(0.50), _PCT(0.90), _PCT(0.99),
+            _PCT(0.999), _PCT(1.0), extra);
+#undef _PCT
+    fflush(out);
+}
+
+//!
+//! Splits a comma-separated list in place
+//!
+//! @param[in,out] list the list, whose commas are replaced with terminators
+//! @param[out]    items array receiving the items
+//! @param[in]     size room in items[]
+//!
+//! @return the number of items or -1 if there are more than 'size' of them
+//!
+static int bench_split(char *list, char **items, int size)
+{
+    int len = 0;
+    char *saveptr = NULL;
+
+    for (char *item = strtok_r(list, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        if (len == size)
+            return (-1);
+        items[len++] = item;
+    }
+    return (len);
+}
+
+//!
+//! Removes the log and the files it was rotated into
+//!
+//! @param[in] path the log
+//!
+static void bench_clean(const char *path)
+{
+    char file[EUCA_MAX_PATH] = "";
+
+    unlink(path);
+    for (int i = 0; i < BENCH_ROLL_NUMBER; i++) {
+        snprintf(file, sizeof(file), "%s.%d", path, i);
+        unlink(file);
+    }
+}
+
+//!
+//! Counts the lines kept in the log and in the files it was rotated into
+//!
+//! @param[in]  path the log
+//! @param[out] files set to the number of files
+//!
+//! @return the number of lines
+//!
+static long long bench_count_lines(const char *path, int *files)
+{
+    int n = 0;
+    long long lines = 0;
+    char buf[65536];
+    char file[EUCA_MAX_PATH] = "";
+    FILE *fp = NULL;
+
+    *files = 0;
+    for (int i = -1; i < BENCH_ROLL_NUMBER; i++) {
+        if (i < 0)
+            euca_strncpy(file, path, sizeof(file));
+        else
+            snprintf(file, sizeof(file), "%s.%d", path, i);
+        if ((fp = fopen(file, "r")) == NULL)
+            continue;
+        (*files)++;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            for (int j = 0; j < n; j++)
+                lines += (buf[j] == '\n');
+        }
+        fclose(fp);
+    }
+    return (lines);
+}
+
+//!
+//! Thread of a benchmark run: logs its lines through the logging macros, as any caller does,
+//! timing every call
+//!
+//! @param[in] arg the bench_caller of this thread
+//!
+//! @return Always NULL
+//!
+static void *bench_caller_thread(void *arg)
+{
+    long long start = 0;
+    bench_caller *c = ((bench_caller *) arg);
+
+    for (int i = 0; i < c->lines; i++) {
+        start = bench_usec();
+        EUCALOG(c->level, "benchmark line %07d from caller %03d %.*s\n", i, c->id, c->pad, bench_pad);
+        c->usec[i] = bench_usec() - start;
+    }
+    return (NULL);
+}
+
+//!
+//! One process of a benchmark run, forked by bench_run(): starts the caller threads, waits
+//! for them and writes out the lines still queued for the writer thread.
+//!
+//! @param[in]  level level of the lines
+//! @param[in]  first ID of the first caller of this process
+//! @param[in]  threads number of caller threads
+//! @param[in]  lines lines logged by every thread
+//! @param[in]  pad length of the padding that makes the lines as long as requested
+//! @param[out] usec latencies of the calls of this process, 'lines' per thread
+//!
+//! @return the number of threads that could not be started
+//!
+static int bench_process(int level, int first, int threads, int lines, int pad, long long *usec)
+{
+    int errors = 0;
+    bench_caller *callers = NULL;
+
+    if ((callers = EUCA_ZALLOC(threads, sizeof(bench_caller))) == NULL)
+        return (threads);
+
+    for (int t = 0; t < threads; t++) {
+        callers[t].id = first + t;
+        callers[t].level = level;
+        callers[t].lines = lines;
+        callers[t].pad = pad;
+        callers[t].usec = usec + ((long long)t * lines);
+        if (pthread_create(&(callers[t].thread), NULL, bench_caller_thread, &(callers[t])) != 0) {
+            errors++;
+            continue;
+        }
+        callers[t].started = TRUE;
+    }
+    for (int t = 0; t < threads; t++) {
+        if (callers[t].started)
+            pthread_join(callers[t].thread, NULL);
+    }
+    log_async_flush(FALSE);
+
+    EUCA_FREE(callers);
+    return (errors);
+}
+
+//!
+//! Runs 'processes' processes of 'threads' threads that each log 'lines' lines at 'level',
+//! with the log at 'threshold', and reports the latency of the calls and the rate at which
+//! the lines made it to the log. Processes share the log and log_sem, like the Apache
+//! processes of the CC do. Every run starts with an empty log.
+//!
+//! @param[in] out stream to print the results to
+//! @param[in] phase name of the part of the benchmark, for the results
+//! @param[in] path the log
+//! @param[in] level level of the lines
+//! @param[in] threshold level of the log
+//! @param[in] mode "sync", or the policy given to log_async_set()
+//! @param[in] processes number of processes
+//! @param[in] threads number of threads of every process
+//! @param[in] rotate_bytes size at which the log is rotated, 0 for never
+//! @param[in] lines lines logged by every thread
+//! @param[in] line_bytes length of the message of a line, without the prefix
+//!
+//! @return the number of errors
+//!
+static int bench_run(FILE * out, const char *phase, const char *path, int level, int threshold, const char *mode, int processes, int threads, long rotate_bytes,
+                     int lines, int line_bytes)
+{
+    int files = 0;
+    int status = 0;
+    int errors = 0;
+    int pad = MAX(0, MIN((line_bytes - BENCH_MESSAGE_BYTES), BENCH_MAX_PAD));
+    long long elapsed = 0;
+    long long kept = 0;
+    long long total = ((long long)processes) * threads * lines;
+    char config[256] = "";
+    char extra[128] = "";
+    pid_t *pids = NULL;
+    long long *usec = NULL;
+
+    snprintf(config, sizeof(config), "phase=%s level=%s threshold=%s mode=%s sem=%s processes=%d rotate_bytes=%ld line_bytes=%d", phase, log_level_names[level],
+             log_level_names[threshold], mode, ((processes > 1) ? "posix" : "mutex"), processes, rotate_bytes, line_bytes);
+
+    // the latencies are written by the children, so they go to memory shared with them
+    if ((usec = mmap(NULL, (total * sizeof(long long)), (PROT_READ | PROT_WRITE), (MAP_SHARED | MAP_ANONYMOUS), -1, 0)) == MAP_FAILED) {
+        fprintf(out, "log_bench op=setup %s skipped=1\n", config);
+        return (1);
+    }
+    if ((pids = EUCA_ZALLOC(processes, sizeof(pid_t))) == NULL) {
+        munmap(usec, (total * sizeof(long long)));
+        return (1);
+    }
+
+    bench_clean(path);
+    log_sem_set((processes > 1) ? bench_posix_sem : bench_mutex_sem);
+    log_params_set(threshold, BENCH_ROLL_NUMBER, ((rotate_bytes > 0) ? rotate_bytes : LONG_MAX));
+    log_file_set(path, NULL);
+    if (log_async_set(strcmp(mode, "sync") ? mode : NULL) != EUCA_OK) {
+        fprintf(out, "log_bench op=setup %s skipped=1\n", config);
+        errors++;
+        goto cleanup;
+    }
+    fflush(NULL);                      // nothing buffered must be written twice
+
+    elapsed = bench_usec();
+    for (int p = 0; p < processes; p++) {
+        if ((pids[p] = fork()) == 0) {
+            _exit(bench_process(level, (p * threads), threads, lines, pad, (usec + ((long long)p * threads * lines))));
+        } else if (pids[p] < 0) {
+            errors++;
+        }
+    }
+    for (int p = 0; p < processes; p++) {
+        if ((pids[p] > 0) && ((waitpid(pids[p], &status, 0) != pids[p]) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)))
+            errors++;
+    }
+    elapsed = bench_usec() - elapsed;
+
+    kept = bench_count_lines(path, &files);
+    snprintf(extra, sizeof(extra), "lines_kept=%lld files=%d failed=%d", kept, files, errors);
+    bench_report(out, ((level < threshold) ? "filtered" : "logprintfl"), config, (processes * threads), usec, total, elapsed, extra);
+
+cleanup:
+    log_async_set(NULL);
+    munmap(usec, (total * sizeof(long long)));
+    EUCA_FREE(pids);
+    return (errors);
+}
+
+//!
+//! Runs the logging benchmarks. First, every level in the list is logged at that level by a
+//! single thread, which shows what each prefix costs, and levels below INFO are also logged
+//! with the log at INFO, which shows what a disabled LOGTRACE() costs. Then the lines at the
+//! scale level are logged by every combination of mode, process count, thread count and
+//! rotation size.
+//!
+//! Usage: bench_log [-l levels] [-L scale-level] [-a sync,block,drop] [-p processes] [-t threads]
+//! [-z rotate-bytes] [-n lines] [-s line-bytes] [-d dir] [-o file], where all but -L, -n, -s, -d
+//! and -o take comma-separated lists, and a rotation size of 0 means that the log never rotates.
+//! Results go to stdout or the given file, one 'log_bench' line per run, and the logs to a
+//! temporary directory or the given one.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+static int do_benchmark(int argc, char **argv)
+{
+    int ch = 0;
+    int level = 0;
+    int errors = 0;
+    int scale = EUCA_LOG_TRACE;
+    int lines = BENCH_DEFAULT_LINES;
+    int line_bytes = BENCH_DEFAULT_LINE_BYTES;
+    int levels_len = 0;
+    int modes_len = 0;
+    int processes_len = 0;
+    int threads_len = 0;
+    int rotations_len = 0;
+    char dir[EUCA_MAX_PATH] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char sem_name[64] = "";
+    char levels_opt[256] = BENCH_DEFAULT_LEVELS;
+    char modes_opt[256] = BENCH_DEFAULT_MODES;
+    char processes_opt[256] = BENCH_DEFAULT_PROCESSES;
+    char threads_opt[256] = BENCH_DEFAULT_THREADS;
+    char rotations_opt[256] = BENCH_DEFAULT_ROTATIONS;
+    char *levels[BENCH_MAX_LIST] = { NULL };
+    char *modes[BENCH_MAX_LIST] = { NULL };
+    char *processes[BENCH_MAX_LIST] = { NULL };
+    char *threads[BENCH_MAX_LIST] = { NULL };
+    char *rotations[BENCH_MAX_LIST] = { NULL };
+    boolean temporary = TRUE;
+    FILE *out = stdout;
+
+    while ((ch = getopt(argc, argv, "l:L:a:p:t:z:n:s:d:o:")) != -1) {
+        switch (ch) {
+        case 'l':
+            euca_strncpy(levels_opt, optarg, sizeof(levels_opt));
+            break;
+        case 'L':
+            scale = log_level_int(optarg);
+            break;
+        case 'a':
+            euca_strncpy(modes_opt, optarg, sizeof(modes_opt));
+            break;
+        case 'p':
+            euca_strncpy(processes_opt, optarg, sizeof(processes_opt));
+            break;
+        case 't':
+            euca_strncpy(threads_opt, optarg, sizeof(threads_opt));
+            break;
+        case 'z':
+            euca_strncpy(rotations_opt, optarg, sizeof(rotations_opt));
+            break;
+        case 'n':
+            lines = atoi(optarg);
+            break;
+        case 's':
+            line_bytes = atoi(optarg);
+            break;
+        case 'd':
+            euca_strncpy(dir, optarg, sizeof(dir));
+            temporary = FALSE;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            printf("Usage: bench_log [-l levels] [-L scale-level] [-a sync,block,drop] [-p processes] [-t threads] [-z rotate-bytes] [-n lines] [-s line-bytes] "
+                   "[-d dir] [-o file]\n");
+            return (1);
+        }
+    }
+
+    if (((levels_len = bench_split(levels_opt, levels, BENCH_MAX_LIST)) < 0) || ((modes_len = bench_split(modes_opt, modes, BENCH_MAX_LIST)) < 0)
+        || ((processes_len = bench_split(processes_opt, processes, BENCH_MAX_LIST)) < 0) || ((threads_len = bench_split(threads_opt, threads, BENCH_MAX_LIST)) < 0)
+        || ((rotations_len = bench_split(rotations_opt, rotations, BENCH_MAX_LIST)) < 0)) {
+        printf("ERROR: at most %d entries are allowed in a list\n", BENCH_MAX_LIST);
+        return (1);
+    }
+    if ((scale <= EUCA_LOG_ALL) || (scale >= EUCA_LOG_OFF) || (lines < 1)) {
+        printf("ERROR: the scale level must be one of EXTREME to FATAL and the line count must be positive\n");
+        return (1);
+    }
+    for (int i = 0; i < levels_len; i++) {
+        if (((level = log_level_int(levels[i])) <= EUCA_LOG_ALL) || (level >= EUCA_LOG_OFF)) {
+            printf("ERROR: unknown log level '%s'\n", levels[i]);
+            return (1);
+        }
+    }
+    for (int i = 0; i < modes_len; i++) {
+        if (strcmp(modes[i], "sync") && strcmp(modes[i], "block") && strcmp(modes[i], "drop")) {
+            printf("ERROR: unknown logging mode '%s'\n", modes[i]);
+            return (1);
+        }
+    }
+    for (int i = 0; i < processes_len; i++) {
+        if ((atoi(processes[i]) < 1) || (atoi(processes[i]) > BENCH_MAX_PROCESSES)) {
+            printf("ERROR: process counts must be within 1 and %d\n", BENCH_MAX_PROCESSES);
+            return (1);
+        }
+    }
+    for (int i = 0; i < threads_len; i++) {
+        if ((atoi(threads[i]) < 1) || (atoi(threads[i]) > BENCH_MAX_THREADS)) {
+            printf("ERROR: thread counts must be within 1 and %d\n", BENCH_MAX_THREADS);
+            return (1);
+        }
+    }
+
+    if (temporary) {
+        euca_strncpy(dir, "/tmp/bench_log-XXXXXX", sizeof(dir));
+        if (mkdtemp(dir) == NULL) {
+            printf("ERROR: failed to create a directory for the logs\n");
+            return (1);
+        }
+    }
+    snprintf(path, sizeof(path), "%s/bench.log", dir);
+    memset(bench_pad, 'x', BENCH_MAX_PAD);
+
+    // the CC shares a named semaphore between its processes, the NC uses a mutex between its threads
+    snprintf(sem_name, sizeof(sem_name), "/eucalyptus-bench-log-%d", getpid());
+    if (((bench_mutex_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE)) == NULL) || ((bench_posix_sem = sem_realloc(1, sem_name, O_EXCL)) == NULL)) {
+        printf("ERROR: failed to allocate the log semaphores\n");
+        errors++;
+        goto cleanup;
+    }
+
+    for (int i = 0; i < levels_len; i++) {
+        level = log_level_int(levels[i]);
+        errors += bench_run(out, "levels", path, level, level, "sync", 1, 1, 0, lines, line_bytes);
+        if (level < EUCA_LOG_INFO)
+            errors += bench_run(out, "levels", path, level, EUCA_LOG_INFO, "sync", 1, 1, 0, lines, line_bytes);
+    }
+
+    for (int m = 0; m < modes_len; m++) {
+        for (int p = 0; p < processes_len; p++) {
+            for (int t = 0; t < threads_len; t++) {
+                for (int z = 0; z < rotations_len; z++) {
+                    errors += bench_run(out, "scale", path, scale, scale, modes[m], atoi(processes[p]), atoi(threads[t]), atol(rotations[z]), lines, line_bytes);
+                }
+            }
+        }
+    }
+
+cleanup:
+    log_file_set(NULL, NULL);
+    log_sem_set(bench_mutex_sem);      // so that the posix one is no longer in use
+    SEM_FREE(bench_posix_sem);
+    bench_clean(path);
+    if (temporary)
+        rmdir(dir);
+    if (out != stdout)
+        fclose(out);
+    return (errors);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+int main(int argc, char **argv)
+{
+    return (do_benchmark(argc, argv));
+}
+#endif /* _BENCHMARK */
@@ -158,6 +158,8 @@ int log_file_set(const char *file, const char *req_track_file);
 int log_prefix_set(const char *log_spec);
 int log_facility_set(const char *facility, const char *component_name);
 int log_sem_set(sem * s);
+int log_async_set(const char *policy);
+void log_async_flush(boolean in_signal);
 int logfile(const char *file, int log_level_in, int log_roll_number_in);
 int logprintf(const char *format, ...) _attribute_format_(1, 2);
 int logprintfl(const char *func, const char *file, int line, log_level_e level, const char *format, ...) _attribute_format_(5, 6);
@@ -99,6 +99,11 @@
 #include <sys/mman.h>                  // mmap
 #include <pthread.h>
 #include <sys/select.h>                // pselect
+#include <sys/syscall.h>               // SYS_pidfd_open
+#include <signal.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/socket.h>                // socketpair, SCM_RIGHTS
 
 #include "eucalyptus.h"
 
@@ -110,6 +115,7 @@
 #include "log.h"
 #include "euca_string.h"
 #include "ipc.h"
+#include "euca_privd.h"
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  DEFINES                                   |
@@ -122,6 +128,16 @@
 #define DEV_STR_IQNS_DELIMITER                    "|"
 #define DEV_STR_KEY_VAL_DELIMITER                 "="
 
+#define RUN_STATS_MAX                             64    //!< number of distinct commands whose latency is counted
+#define RUN_READ_SIZE                           4096    //!< how much of a child's output is read at once
+#define RUN_WAIT_USEC                          10000    //!< how often a child is checked for exit when pidfds are unavailable
+#define PRIVD_POOL_MAX                            16    //!< number of idle connections kept to the privileged helper
+#define FAST_TICKS_CALIBRATION_NSEC          2000000LL    //!< how long the TSC is compared with CLOCK_MONOTONIC to find its rate
+#define FAST_TICKS_CLOCKSOURCE   "/sys/devices/system/clocksource/clocksource0/current_clocksource" //!< names the clock the kernel trusts
+#define PRIVD_GRACE_SEC                            5    //!< how long the privileged helper may take to answer, on top of the command's timeout
+#define PRIVD_RETRY_SEC                           60    //!< how long to wait before starting the privileged helper again after it failed
+#define PRIVD_SHELL_CHARS              "|&;<>()$`\\\"'*?[#~\n"  //!< characters that make a command line need the shell
+
 #ifdef _UNIT_TEST
 #define _STR                                     "a lovely string"
 #endif /* _UNIT_TEST */
@@ -164,14 +180,47 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static euca_run_stats run_stats[RUN_STATS_MAX] = { {{0}} };    //!< latency counters of the commands run so far
+static int run_stats_len = 0;          //!< number of entries in run_stats
+static pthread_mutex_t run_stats_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards run_stats
+
+static pthread_once_t fast_ticks_once = PTHREAD_ONCE_INIT;  //!< runs fast_ticks_calibrate()
+static boolean fast_ticks_tsc = FALSE; //!< set if fast_ticks() reads the TSC rather than CLOCK_MONOTONIC
+static double fast_ticks_usec_per_tick = 0.001; //!< the rate of fast_ticks(), nanoseconds unless it reads the TSC
+
+static pthread_mutex_t privd_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards the privd_ variables
+static pthread_once_t privd_once = PTHREAD_ONCE_INIT;   //!< registers privd_atfork_child()
+static int privd_control = -1;         //!< control socket to the privileged helper, or -1 if it is not running
+static pid_t privd_pid = -1;           //!< the privileged helper
+static pid_t privd_owner = -1;         //!< the process that started the privileged helper
+static time_t privd_failed = 0;        //!< when the privileged helper last failed, on the monotonic clock, or 0 if it never did
+static int privd_pool[PRIVD_POOL_MAX] = { 0 };  //!< idle connections to the privileged helper
+static int privd_pool_len = 0;         //!< number of entries in privd_pool
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-static char *next_tag(const char *xml, int *start, int *end, int *single, int *closing);
-static char *find_cont(const char *xml, char *xpath);
+static boolean scan_tag(const char *xml, int *start, int *end, int *name_start, int *name_len, int *single, int *closing);
+static void xml_path_append(xml_cursor * cursor, const char *s, int len);
+static boolean xml_name_equal(const char *a, const char *b, int len);
+static void log_argv(pid_t pid, char *const argv[]);
+static int spawn_child(pid_t * ppid, char *const argv[], const char *stdin_path, int *stdin_fd, int *stdout_fd, int *stderr_fd, int flags);
+static int gather_output(int exit_fd, int out_fd, int err_fd, long long deadline, char **pOutput, char **pError, boolean * pExited);
+static int collect_child(pid_t pid, int out_fd, int err_fd, int timeout_sec, char **pOutput, char **pError, int *pStatus);
+static int append_output(char **pBuf, size_t * pLen, int fd);
+static void run_stats_record(char *const argv[], const char *command, long long usec, int result);
+static void privd_forget(void);
+static void fast_ticks_calibrate(void);
+static void privd_atfork_child(void);
+static void privd_init_atfork(void);
+static void privd_stop(void);
+static int privd_start(const char *rootwrap);
+static int privd_connect(const char *rootwrap);
+static void privd_release(int conn, boolean reuse);
+static boolean privd_run(char *const argv[], const char *stdin_path, int flags, int timeout_sec, char **pOutput, char **pError, int *pStatus, int *pResult);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -618,20 +667,13 @@ int check_process(pid_t pid, char *search)
 char *system_output(char *shell_command)
 {
     char *buf = NULL;
-    FILE *fp = NULL;
 
     if (!shell_command)
         return (NULL);
 
-    // forks off command (this doesn't fail if command doesn't exist
+    // like popen(), the output is returned whatever the exit code of the command
     LOGTRACE("[%s]\n", shell_command);
-    if ((fp = popen(shell_command, "r")) == NULL) {
-        // caller can check errno
-        return (NULL);
-    }
-
-    buf = fp2str(fp);
-    pclose(fp);
+    euca_run_shell(shell_command, 0, 0, &buf, NULL, NULL);
     return (buf);
 }
 
@@ -1265,31 +1307,31 @@ int minint(int a, int b)
 
 //!
 //! given a null-terminated string in 'xml', finds the next complete <tag...>
-//! and returns its name in a newly allocated string (which must be freed by
-//! the caller) or returns NULL if no tag can be found or if the XML is not
-//! well formed; when not NULL, the following parameters are also returned:
+//! without copying anything; returns FALSE if no tag can be found or if the
+//! XML is not well formed, and TRUE along with the following otherwise:
 //!
-//!     start   = index of the '<' character
-//!     end     = index of the '>' character
-//!     single  = 1 if this is a <..../> tag
-//!     closing = 1 if this is a </....> tag
+//!     start      = index of the '<' character
+//!     end        = index of the '>' character
+//!     name_start = index of the first character of the name of the tag
+//!     name_len   = length of the name of the tag
+//!     single     = 1 if this is a <..../> tag
+//!     closing    = 1 if this is a </....> tag
 //!
 //! @param[in]  xml
 //! @param[out] start
 //! @param[out] end
+//! @param[out] name_start
+//! @param[out] name_len
 //! @param[out] single
 //! @param[out] closing
 //!
-//! @return the name of the next complete xml tag
+//! @return TRUE if a complete xml tag was found, FALSE otherwise
 //!
-//! @note the caller is responsible to free the returned memory
-//!
-static char *next_tag(const char *xml, int *start, int *end, int *single, int *closing)
+static boolean scan_tag(const char *xml, int *start, int *end, int *name_start, int *name_len, int *single, int *closing)
 {
-    int name_start = -1;
-    int name_end = -1;
+    int nstart = -1;
+    int nend = -1;
     int tag_start = -1;
-    char *ret = NULL;
     const char *p = NULL;
     const char *last_ch = NULL;
 
@@ -1301,21 +1343,21 @@ static char *next_tag(const char *xml, int *start, int *end, int *single, int *c
             if ((*(p + 1) == '/') || (*(p + 1) == '?')) {
                 if (*(p + 1) == '/')   // if followed by '/' then it is a "closing" tag
                     *closing = 1;
-                name_start = (p - xml + 2);
+                nstart = (p - xml + 2);
                 p++;
             } else {
-                name_start = (p - xml + 1);
+                nstart = (p - xml + 1);
             }
             continue;
         }
 
-        if ((*p == ' ') && (name_start != -1) && (name_end == -1)) {    // a name may be terminated by a space
-            name_end = (p - 1 - xml);
+        if ((*p == ' ') && (nstart != -1) && (nend == -1)) {    // a name may be terminated by a space
+            nend = (p - 1 - xml);
             continue;
         }
 
         if (*p == '>') {
-            if (name_start == -1)      // never saw '<', error
+            if (nstart == -1)          // never saw '<', error
                 break;
 
             if (p < (xml + 2))         // tag is too short, error
@@ -1329,125 +1371,231 @@ static char *next_tag(const char *xml, int *start, int *end, int *single, int *c
                 *single = 0;
             }
 
-            if ((name_start != -1) && (name_end == -1)) {   // a name may be terminated by '/' or '>' or '?'
-                name_end = (last_ch - xml);
+            if ((nstart != -1) && (nend == -1)) {   // a name may be terminated by '/' or '>' or '?'
+                nend = (last_ch - xml);
             }
 
-            if ((name_end - name_start) >= 0) { // we have a name rather than '<>'
-                if ((ret = EUCA_ZALLOC(name_end - name_start + 2, sizeof(char))) == NULL)
-                    break;
-                strncpy(ret, xml + name_start, name_end - name_start + 1);
+            if ((nend - nstart) >= 0) { // we have a name rather than '<>'
+                *name_start = nstart;
+                *name_len = nend - nstart + 1;
                 *start = tag_start;
                 *end = p - xml;
+                return (TRUE);
             }
             break;
         }
     }
 
-    return (ret);
+    return (FALSE);
 }
 
 //!
-//! given a null-terminated string in 'xml' and an 'xpath' of an XML
-//! element, returns the "content" of that element in a newly allocated
-//! string; for example, with XML:
+//! Appends characters to the path of a cursor, in lower case, as much as fits
 //!
-//!   "<a><b>foo</b><c><d>bar</d><e>baz</e></c></a>"
+//! @param[in] cursor
+//! @param[in] s the characters to append
+//! @param[in] len number of characters to append
 //!
-//! the content returned for xpath "a/c/e" is "baz"
+static void xml_path_append(xml_cursor * cursor, const char *s, int len)
+{
+    int i = 0;
+    int room = (EUCA_MAX_PATH - 2) - cursor->path_len;
+
+    if (len > room)
+        len = room;
+    for (i = 0; i < len; i++)
+        cursor->path[cursor->path_len + i] = tolower(s[i]);
+    cursor->path_len += len;
+    cursor->path[cursor->path_len] = '\0';
+}
+
 //!
-//! @param[in] xml
-//! @param[in] xpath
+//! Tells whether two names are the same, ignoring case
 //!
-//! @return a pointer to the content we're looking for
+//! @param[in] a the first name
+//! @param[in] b the second name
+//! @param[in] len length of both names
 //!
-//! @note the caller is responsible to free the returned memory
+//! @return TRUE if they are the same, FALSE otherwise
 //!
-static char *find_cont(const char *xml, char *xpath)
+static boolean xml_name_equal(const char *a, const char *b, int len)
 {
-#define _STK_SIZE            64
-
     int i = 0;
-    int xpathLen = 0;
-    int xml_offset = 0;
-    int tag_start = 1;
-    int tag_end = -1;
+
+    for (i = 0; i < len; i++) {
+        if (tolower(a[i]) != tolower(b[i]))
+            return (FALSE);
+    }
+    return (TRUE);
+}
+
+//!
+//! Starts a single pass over an XML document. Nothing is copied or allocated:
+//! the elements returned by xml_cursor_next() point into 'xml', which must stay
+//! as is while the cursor is used.
+//!
+//! @param[out] cursor the cursor to start
+//! @param[in]  xml the null-terminated document
+//!
+//! @see xml_cursor_next()
+//!
+void xml_cursor_init(xml_cursor * cursor, const char *xml)
+{
+    if (cursor == NULL)
+        return;
+
+    cursor->xml = xml;
+    cursor->offset = 0;
+    cursor->depth = 0;
+    cursor->closed = FALSE;
+    cursor->error = FALSE;
+    cursor->path_len = 0;
+    cursor->path[0] = '\0';
+}
+
+//!
+//! Moves a cursor to the next element to close, so elements come out in the order of
+//! their closing tags: for "<a><b>foo</b><c>bar</c></a>", "a/b" then "a/c" then "a".
+//! Element names and xpaths are compared without regard to case, like xpath_content()
+//! does, and the pass ends at the first tag that does not close the innermost open
+//! element or at the first element nested deeper than XML_CURSOR_DEPTH.
+//!
+//! @param[in,out] cursor the cursor started with xml_cursor_init()
+//! @param[out]    element set to the element, whose path is valid until the next call
+//!
+//! @return EUCA_OK if an element was found, EUCA_NOT_FOUND_ERROR at the end of the
+//!         document or EUCA_INVALID_ERROR if it is malformed
+//!
+int xml_cursor_next(xml_cursor * cursor, xml_element * element)
+{
+    int start = 0;
+    int end = 0;
+    int name_start = 0;
+    int name_len = 0;
     int single = 0;
     int closing = 0;
-    int stk_p = -1;
-    int cont_len = 0;
-    char *ret = NULL;
-    char *cont = NULL;
-    char *name = NULL;
-    char *name_lc = NULL;
-    char *n_stk[_STK_SIZE] = { NULL };
-    char xpath_cur[EUCA_MAX_PATH] = "";
-    const char *contp = NULL;
-    const char *c_stk[_STK_SIZE] = { NULL };
-
-    // iterate over tags until the matching xpath is reached or until no more tags are found in the 'xml'
-    bzero(n_stk, sizeof(char *) * _STK_SIZE);
-
-    for (xml_offset = 0; (name = next_tag(xml + xml_offset, &tag_start, &tag_end, &single, &closing)) != NULL; xml_offset += tag_end + 1) {
+    const char *tag = NULL;
+
+    if ((cursor == NULL) || (element == NULL) || cursor->error)
+        return (EUCA_INVALID_ERROR);
+
+    // the element yielded last is off the path now
+    if (cursor->closed) {
+        cursor->path_len = cursor->path_lens[cursor->depth];
+        cursor->path[cursor->path_len] = '\0';
+        cursor->closed = FALSE;
+    }
+
+    while (cursor->xml && scan_tag(cursor->xml + cursor->offset, &start, &end, &name_start, &name_len, &single, &closing)) {
+        tag = cursor->xml + cursor->offset;
+        cursor->offset += end + 1;
+
         if (single) {
             // not interested in singles because we are looking for content
-        } else if (!closing) {         // opening a tag
-            // put name and pointer to content onto the stack
-            stk_p++;
-            if (stk_p == _STK_SIZE)    // exceeding stack size, error
-                goto cleanup;
-            n_stk[stk_p] = euca_strduptolower(name);    // put a lower-case-only copy onto stack
-            c_stk[stk_p] = xml + xml_offset + tag_end + 1;
-        } else {                       // closing tag
-            // get the name in all lower-case, for consistency with xpath
-            name_lc = euca_strduptolower(name);
-            EUCA_FREE(name);
-            name = name_lc;
-
-            // name doesn't match last seen opening tag, error
-            if (stk_p >= 0) {
-                if (!n_stk[stk_p] || (strcmp(n_stk[stk_p], name) != 0)) {
-                    goto cleanup;
-                }
-            }
-            // construct the xpath of the closing tag based on stack contents
-            xpath_cur[0] = '\0';
-            for (i = 0, xpathLen = EUCA_MAX_PATH - 1; i <= stk_p; i++) {
-                if (i > 0) {
-                    strncat(xpath_cur, "/", (xpathLen - strlen(xpath_cur) - 1));
-                }
-                strncat(xpath_cur, n_stk[i], (xpathLen - strlen(xpath_cur) - 1));
+            continue;
+        }
+
+        if (!closing) {
+            if (cursor->depth == XML_CURSOR_DEPTH) {
+                cursor->error = TRUE;
+                return (EUCA_INVALID_ERROR);
             }
+            cursor->names[cursor->depth].start = tag + name_start;
+            cursor->names[cursor->depth].len = name_len;
+            cursor->contents[cursor->depth] = tag + end + 1;
+            cursor->path_lens[cursor->depth] = cursor->path_len;
+            if (cursor->depth > 0)
+                xml_path_append(cursor, "/", 1);
+            xml_path_append(cursor, tag + name_start, name_len);
+            cursor->depth++;
+            continue;
+        }
+        // a closing tag must match the last seen opening tag
+        if ((cursor->depth == 0) || (cursor->names[cursor->depth - 1].len != name_len)
+            || !xml_name_equal(cursor->names[cursor->depth - 1].start, tag + name_start, name_len)) {
+            cursor->error = TRUE;
+            return (EUCA_INVALID_ERROR);
+        }
 
-            // pop the stack whether we have a match or not
-            if (stk_p < 0)             // past the bottom of the stack, error
-                goto cleanup;
+        cursor->depth--;
+        cursor->closed = TRUE;
+        element->path = cursor->path;
+        element->depth = cursor->depth;
+        element->name = cursor->names[cursor->depth];
+        element->content.start = cursor->contents[cursor->depth];
+        element->content.len = (tag + start) - cursor->contents[cursor->depth];
+        return (EUCA_OK);
+    }
 
-            contp = c_stk[stk_p];
-            cont_len = xml + xml_offset + tag_start - contp;
-            EUCA_FREE(n_stk[stk_p]);
-            stk_p--;
+    return (EUCA_NOT_FOUND_ERROR);
+}
 
-            // see if current xpath matches the requested one
-            if (strcmp(xpath, xpath_cur) == 0) {
-                if ((cont = EUCA_ZALLOC(cont_len + 1, sizeof(char))) == NULL)
-                    goto cleanup;
-                strncpy(cont, contp, cont_len);
-                ret = cont;
-                break;
+//!
+//! given a null-terminated string in 'xml' and the 'xpaths' of XML elements, finds the
+//! "content" of each of them in a single pass over the document, stopping as soon as all
+//! of them are found; for example, with XML:
+//!
+//!   "<a><b>foo</b><c><d>bar</d><e>baz</e></c></a>"
+//!
+//! the content found for xpath "a/c/e" is "baz". As with xpath_content(), the content of
+//! an xpath is the one of the first matching element to close.
+//!
+//! @param[in]  xml
+//! @param[in]  xpaths the xpaths of the elements to find
+//! @param[in]  nxpaths number of xpaths
+//! @param[out] slices one slice per xpath, set to the content of its element, which
+//!             points into 'xml', or left with a NULL start if it was not found
+//!
+//! @return EUCA_OK if all the xpaths were found, EUCA_NOT_FOUND_ERROR if some were not
+//!         or EUCA_INVALID_ERROR if any parameter is invalid
+//!
+//! @see xml_cursor_next()
+//!
+int xpath_extract(const char *xml, const char **xpaths, int nxpaths, xml_slice * slices)
+{
+    int i = 0;
+    int found = 0;
+    xml_cursor cursor = { 0 };
+    xml_element element = { 0 };
+
+    if ((xml == NULL) || (xpaths == NULL) || (slices == NULL) || (nxpaths < 0))
+        return (EUCA_INVALID_ERROR);
+
+    bzero(slices, (nxpaths * sizeof(xml_slice)));
+    xml_cursor_init(&cursor, xml);
+    while ((found < nxpaths) && (xml_cursor_next(&cursor, &element) == EUCA_OK)) {
+        for (i = 0; i < nxpaths; i++) {
+            if ((slices[i].start == NULL) && xpaths[i] && !strcasecmp(element.path, xpaths[i])) {
+                slices[i] = element.content;
+                found++;
             }
         }
-        EUCA_FREE(name);
-        name = NULL;
     }
 
-cleanup:
-    EUCA_FREE(name);                   // for exceptions
-    for (i = 0; i <= stk_p; i++)
-        EUCA_FREE(n_stk[i]);           // free everything on the stack
-    return (ret);
+    return ((found == nxpaths) ? EUCA_OK : EUCA_NOT_FOUND_ERROR);
+}
+
+//!
+//! Copies a slice of an XML document into a new string
+//!
+//! @param[in] slice
+//!
+//! @return the copy or NULL if the slice is unset or if we fail to allocate memory
+//!
+//! @note the caller is responsible to free the returned memory
+//!
+char *xml_slice_dup(const xml_slice * slice)
+{
+    char *copy = NULL;
 
-#undef _STK_SIZE
+    if ((slice == NULL) || (slice->start == NULL))
+        return (NULL);
+
+    if ((copy = EUCA_ALLOC((slice->len + 1), sizeof(char))) != NULL) {
+        memcpy(copy, slice->start, slice->len);
+        copy[slice->len] = '\0';
+    }
+    return (copy);
 }
 
 //!
@@ -1464,25 +1612,20 @@ cleanup:
 //!
 //! @return a pointer to the content we're looking for
 //!
-//! @see find_cont()
+//! @see xpath_extract() to find several xpaths in one pass without copies
 //!
 //! @note the caller is responsible to free the returned memory
 //!
 char *xpath_content(const char *xml, const char *xpath)
 {
-    char *ret = NULL;
-    char *xpath_l = NULL;
+    xml_slice slice = { 0 };
 
     if ((xml == NULL) || (xpath == NULL))
         return (NULL);
 
-    xpath_l = euca_strduptolower(xpath);    // lower-case copy of requested xpath
-    if (xpath_l != NULL) {
-        ret = find_cont(xml, xpath_l);
-        EUCA_FREE(xpath_l);
-    }
-
-    return (ret);
+    if (xpath_extract(xml, &xpath, 1, &slice) != EUCA_OK)
+        return (NULL);
+    return (xml_slice_dup(&slice));
 }
 
 //!
@@ -1614,6 +1757,138 @@ long long time_ms(void)
     return (time_usec() / 1000);
 }
 
+//!
+//! time on the monotonic clock in nanoseconds. Unlike time_usec(), it is not changed or slewed
+//! by NTP or by setting the date, so it is what elapsed times, deadlines and timeouts are
+//! measured with. It counts from an arbitrary point, the boot of the host, and is the same
+//! in all the processes of the host.
+//!
+//! @return the time on the monotonic clock in nanoseconds
+//!
+long long mono_time_nsec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec * NANOSECONDS_IN_SECOND) + ts.tv_nsec);
+}
+
+//!
+//! time on the monotonic clock in microseconds
+//!
+//! @return the time on the monotonic clock in microseconds
+//!
+//! @see mono_time_nsec()
+//!
+long long mono_time_usec(void)
+{
+    return (mono_time_nsec() / 1000);
+}
+
+//!
+//! time on the monotonic clock in milliseconds
+//!
+//! @return the time on the monotonic clock in milliseconds
+//!
+//! @see mono_time_nsec()
+//!
+long long mono_time_ms(void)
+{
+    return (mono_time_nsec() / 1000000);
+}
+
+//!
+//! time on the monotonic clock in seconds, to measure timeouts in the place of time(NULL)
+//!
+//! @return the time on the monotonic clock in seconds
+//!
+//! @see mono_time_nsec()
+//!
+time_t mono_time_sec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec);
+}
+
+//!
+//! Reads a cheap timer meant for statistics taken on hot paths, like lock hold times. On x86
+//! hosts whose kernel keeps time with the TSC this reads the TSC, which is synchronized across
+//! the CPUs then, and it falls back to CLOCK_MONOTONIC otherwise. Only the difference between
+//! two readings in the same process means something, see fast_ticks_usec().
+//!
+//! @return the current value of the timer, in ticks
+//!
+long long fast_ticks(void)
+{
+    pthread_once(&fast_ticks_once, fast_ticks_calibrate);
+#if defined(__x86_64__) || defined(__i386__)
+    if (fast_ticks_tsc) {
+        unsigned int lo = 0;
+        unsigned int hi = 0;
+
+        __asm__ __volatile__("rdtsc":"=a"(lo), "=d"(hi));
+        return ((long long)(((unsigned long long)hi << 32) | lo));
+    }
+#endif /* __x86_64__ || __i386__ */
+    return (mono_time_nsec());
+}
+
+//!
+//! Converts fast_ticks() ticks to microseconds
+//!
+//! @param[in] ticks a number of ticks, usually the difference between two fast_ticks() readings
+//!
+//! @return the number of microseconds
+//!
+long long fast_ticks_usec(long long ticks)
+{
+    pthread_once(&fast_ticks_once, fast_ticks_calibrate);
+    return ((long long)(ticks * fast_ticks_usec_per_tick));
+}
+
+//!
+//! Decides whether fast_ticks() can read the TSC and if so, measures its rate against
+//! CLOCK_MONOTONIC for FAST_TICKS_CALIBRATION_NSEC
+//!
+static void fast_ticks_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    int fd = -1;
+    ssize_t len = 0;
+    char source[32] = "";
+    unsigned int lo = 0;
+    unsigned int hi = 0;
+    long long start_nsec = 0;
+    long long end_nsec = 0;
+    unsigned long long start_tsc = 0;
+    unsigned long long end_tsc = 0;
+
+    // the kernel only keeps time with the TSC when it is invariant and in sync across the CPUs
+    if ((fd = open(FAST_TICKS_CLOCKSOURCE, O_RDONLY)) < 0)
+        return;
+    len = read(fd, source, (sizeof(source) - 1));
+    close(fd);
+    if ((len < 3) || strncmp(source, "tsc", 3))
+        return;
+
+    start_nsec = mono_time_nsec();
+    __asm__ __volatile__("rdtsc":"=a"(lo), "=d"(hi));
+    start_tsc = (((unsigned long long)hi << 32) | lo);
+    do {
+        end_nsec = mono_time_nsec();
+        __asm__ __volatile__("rdtsc":"=a"(lo), "=d"(hi));
+        end_tsc = (((unsigned long long)hi << 32) | lo);
+    } while ((end_nsec - start_nsec) < FAST_TICKS_CALIBRATION_NSEC);
+
+    if (end_tsc <= start_tsc)
+        return;
+    fast_ticks_usec_per_tick = ((double)(end_nsec - start_nsec)) / (1000.0 * (end_tsc - start_tsc));
+    fast_ticks_tsc = TRUE;
+#endif /* __x86_64__ || __i386__ */
+}
+
 //!
 //! try to get UUID of the block device
 //!
@@ -1719,136 +1994,33 @@ int drop_privs(void)
 //! @param[in] max_size
 //! @param[in] timeout
 //!
-//! @return -1 for any failures, 0 if a timeout occured or a positive value is success.
+//! @return -1 for any failures, including a timeout, or the exit code of the command
 //!
 int timeshell(char *command, char *stdout_str, char *stderr_str, int max_size, int timeout)
 {
-    int retval;
-    int readn;
-    int stdoutfds[2] = { 0, 0 };
-    int stderrfds[2] = { 0, 0 };
-    int child_pid = 0;
-    int maxfd = 0;
     int rc = 0;
     int status = 0;
-    int stdout_toread = 0;
-    int stderr_toread = 0;
-    char errorBuf[256] = { 0 };
-    time_t start_time = 0;
-    time_t remaining_time = 0;
-    fd_set rfds = { {0} };
-    struct timeval tv = { 0 };
+    char *out = NULL;
+    char *err = NULL;
 
     // force nonempty on all arguments to simplify the logic
     assert(command);
     assert(stdout_str);
     assert(stderr_str);
 
-    if (pipe(stdoutfds) < 0) {
-        strerror_r(errno, errorBuf, 256);
-        LOGERROR("error: failed to create pipe for stdout: %s\n", errorBuf);
-        return (-1);
-    }
-    if (pipe(stderrfds) < 0) {
-        strerror_r(errno, errorBuf, 256);
-        LOGERROR("error: failed to create pipe for stderr: %s\n", errorBuf);
-        return (-1);
-    }
-
-    if ((child_pid = fork()) == 0) {
-        close(stdoutfds[0]);
-        if (dup2(stdoutfds[1], STDOUT_FILENO) < 0) {
-            strerror_r(errno, errorBuf, 256);
-            LOGERROR("error: failed to dup2 stdout: %s\n", errorBuf);
-            exit(1);
-        }
-
-        close(stdoutfds[1]);
-        close(stderrfds[0]);
-
-        if (dup2(stderrfds[1], STDERR_FILENO) < 0) {
-            strerror_r(errno, errorBuf, 256);
-            LOGERROR("error: failed to dup2 stderr: %s\n", errorBuf);
-            exit(1);
-        };
-
-        close(stderrfds[1]);
-
-        execl("/bin/sh", "sh", "-c", command, (char *)0);
+    rc = euca_run_shell(command, 0, timeout, &out, &err, &status);
+    euca_strncpy(stdout_str, NP(out), max_size);
+    euca_strncpy(stderr_str, NP(err), max_size);
+    EUCA_FREE(out);
+    EUCA_FREE(err);
 
-        exit(127);
-    }
-
-    close(stdoutfds[1]);
-    close(stderrfds[1]);
-
-    if (child_pid < 0) {
-        close(stdoutfds[0]);
-        close(stderrfds[0]);
-        return (-1);
-    }
-
-    memset(stdout_str, 0, max_size);
-    memset(stderr_str, 0, max_size);
-    stdout_toread = stderr_toread = max_size - 1;
-
-    maxfd = ((stdoutfds[0] > stderrfds[0]) ? stdoutfds[0] : stderrfds[0]);
-
-    start_time = time(NULL);
-    for (;;) {
-        FD_ZERO(&rfds);
-        FD_SET(stdoutfds[0], &rfds);
-        FD_SET(stderrfds[0], &rfds);
-
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-
-        if ((retval = select(maxfd + 1, &rfds, (fd_set *) 0, (fd_set *) 0, &tv)) > 0) {
-            if (FD_ISSET(stdoutfds[0], &rfds) && stdout_toread > 0) {
-                if ((readn = read(stdoutfds[0], stdout_str, stdout_toread)) > 0) {
-                    stdout_toread -= readn;
-                    stdout_str += readn;
-                } else {
-                    break;
-                }
-            }
-
-            if (FD_ISSET(stderrfds[0], &rfds) && stderr_toread > 0) {
-                if ((readn = read(stderrfds[0], stderr_str, stderr_toread)) > 0) {
-                    stderr_toread -= readn;
-                    stderr_str += readn;
-                } else {
-                    break;
-                }
-            }
-        } else if (retval < 0) {
-            strerror_r(errno, errorBuf, 256);
-            LOGWARN("warning: select error on pipe read: %s\n", errorBuf);
-            break;
-        }
-
-        if ((time(NULL) - start_time) > timeout) {
-            LOGWARN("warning: read timeout\n");
-            break;
-        }
-    }
-
-    close(stdoutfds[0]);
-    close(stderrfds[0]);
-
-    remaining_time = timeout - (time(NULL) - start_time);
-    if ((rc = timewait(child_pid, &status, remaining_time)) != 0) {
-        if (WIFEXITED(status))
-            rc = WEXITSTATUS(status);
-        else
-            rc = -1;
-    } else {
-        killwait(child_pid);
+    if (rc == EUCA_TIMEOUT_ERROR) {
         LOGERROR("warning: shell execution timeout\n");
         return (-1);
+    } else if ((rc != EUCA_OK) && (rc != EUCA_ERROR)) {
+        return (-1);
     }
-
-    return (rc);
+    return (WEXITSTATUS(status));
 }
 
 //!
@@ -1968,14 +2140,20 @@ char **build_argv(const char *first, va_list va)
     return argv;
 }
 
-void log_argv(char **argv)
+//!
+//! Logs the command line that a child process was started with
+//!
+//! @param[in] pid the child process
+//! @param[in] argv the NULL-terminated command line
+//!
+static void log_argv(pid_t pid, char *const argv[])
 {
-    char cmd[10240];
+    char cmd[10240] = "";
     int args = 0;
 
-    for (char **s = argv; *s != NULL; s++, args++) {
+    for (char *const *s = argv; *s != NULL; s++, args++) {
         char formatted[1024];
-        char *arg = *s;
+        const char *arg = *s;
         if (args > 0) {
             if (arg[0] == '-') {
                 snprintf(formatted, sizeof(formatted), " %s", arg);
@@ -1987,14 +2165,809 @@ void log_argv(char **argv)
         }
         euca_strncat(cmd, formatted, sizeof(cmd));
     }
-    fprintf(stderr, "child process %d executing: %s\n", getpid(), cmd);
+    LOGDEBUG("child process %d executing: %s\n", pid, cmd);
+}
+
+//!
+//! Starts a child process with posix_spawn(), which on Linux does not copy the page tables
+//! of the caller the way fork() does, so it stays cheap however large the NC or CC grows.
+//! The child gets its own process group, an empty signal mask and the default SIGPIPE
+//! disposition. Pipes are created close-on-exec so that concurrent spawns from other
+//! threads do not inherit each other's ends.
+//!
+//! @param[out] ppid set to the PID of the child
+//! @param[in]  argv the NULL-terminated command line; argv[0] is looked up in $PATH
+//! @param[in]  stdin_path if not NULL, the file the child reads its stdin from
+//! @param[out] stdin_fd if not NULL, set to a pipe feeding the stdin of the child
+//! @param[out] stdout_fd if not NULL, set to a pipe from the stdout of the child
+//! @param[out] stderr_fd if not NULL, set to a pipe from the stderr of the child
+//! @param[in]  flags EUCA_RUN_MERGE_STDERR to send stderr to the stdout pipe
+//!
+//! @return EUCA_OK on success, EUCA_ERROR if pipes cannot be created or EUCA_THREAD_ERROR
+//!         if the child cannot be started
+//!
+static int spawn_child(pid_t * ppid, char *const argv[], const char *stdin_path, int *stdin_fd, int *stdout_fd, int *stderr_fd, int flags)
+{
+    extern char **environ;
+    int i = 0;
+    int rc = 0;
+    int ret = EUCA_OK;
+    int pipes[3][2] = { {-1, -1}, {-1, -1}, {-1, -1} };
+    int *fds[3] = { stdin_fd, stdout_fd, stderr_fd };
+    short attr_flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    sigset_t sigs = { {0} };
+    posix_spawnattr_t attr = { 0 };
+    posix_spawn_file_actions_t actions = { 0 };
+
+    *ppid = -1;
+    for (i = 0; i < 3; i++) {
+        if (fds[i]) {
+            *fds[i] = -1;
+            if (pipe2(pipes[i], O_CLOEXEC) != 0) {
+                LOGERROR("pipe() failed: %s\n", strerror(errno));
+                ret = EUCA_ERROR;
+                goto cleanup;
+            }
+        }
+    }
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+#ifdef POSIX_SPAWN_USEVFORK
+    attr_flags |= POSIX_SPAWN_USEVFORK;
+#endif /* POSIX_SPAWN_USEVFORK */
+    posix_spawnattr_setflags(&attr, attr_flags);
+    posix_spawnattr_setpgroup(&attr, 0);
+    sigemptyset(&sigs);
+    posix_spawnattr_setsigmask(&attr, &sigs);
+    sigaddset(&sigs, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigs);
+
+    if (stdin_fd) {
+        posix_spawn_file_actions_adddup2(&actions, pipes[0][0], STDIN_FILENO);
+    } else if (stdin_path) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, stdin_path, O_RDONLY, 0);
+    }
+    if (stdout_fd) {
+        posix_spawn_file_actions_adddup2(&actions, pipes[1][1], STDOUT_FILENO);
+        if (flags & EUCA_RUN_MERGE_STDERR)
+            posix_spawn_file_actions_adddup2(&actions, pipes[1][1], STDERR_FILENO);
+    }
+    if (stderr_fd) {
+        posix_spawn_file_actions_adddup2(&actions, pipes[2][1], STDERR_FILENO);
+    }
+
+    if ((rc = posix_spawnp(ppid, argv[0], &actions, &attr, argv, environ)) != 0) {
+        LOGERROR("failed to start '%s': %s\n", argv[0], strerror(rc));
+        *ppid = -1;
+        ret = EUCA_THREAD_ERROR;
+    } else {
+        log_argv(*ppid, argv);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+cleanup:
+    // keep the parent's ends of the pipes, close everything else
+    for (i = 0; i < 3; i++) {
+        if (fds[i] && (ret == EUCA_OK)) {
+            *fds[i] = pipes[i][(i == 0) ? 1 : 0];
+            pipes[i][(i == 0) ? 1 : 0] = -1;
+        }
+        if (pipes[i][0] >= 0)
+            close(pipes[i][0]);
+        if (pipes[i][1] >= 0)
+            close(pipes[i][1]);
+    }
+    return (ret);
+}
+
+//!
+//! Reads what is available from a child's pipe and appends it to a buffer
+//!
+//! @param[in,out] pBuf the NUL-terminated buffer, reallocated as needed
+//! @param[in,out] pLen the length of the data in the buffer
+//! @param[in]     fd the pipe
+//!
+//! @return the number of bytes read, 0 on end of file or -1 on error
+//!
+static int append_output(char **pBuf, size_t * pLen, int fd)
+{
+    ssize_t bytes = 0;
+    char *buf = NULL;
+
+    if ((buf = EUCA_REALLOC(*pBuf, (*pLen + RUN_READ_SIZE + 1), sizeof(char))) == NULL)
+        return (-1);
+    *pBuf = buf;
+
+    do {
+        bytes = read(fd, buf + *pLen, RUN_READ_SIZE);
+    } while ((bytes < 0) && (errno == EINTR));
+
+    if (bytes > 0)
+        *pLen += bytes;
+    buf[*pLen] = '\0';
+    return ((bytes < 0) ? -1 : (int)bytes);
+}
+
+//!
+//! Reads the output of a command until it exits. The exit is noticed through exit_fd (a pidfd,
+//! or the connection to the privileged helper) when there is one, so that descendants that keep
+//! the pipes open (daemons started by the command) do not hold up the caller; the pipes are
+//! then drained of what is already in them. Without one, the pipes closing is taken as the exit.
+//!
+//! @param[in]  exit_fd descriptor that becomes readable when the command exits, or -1
+//! @param[in]  out_fd the stdout pipe of the command or -1 if it is not captured
+//! @param[in]  err_fd the stderr pipe of the command or -1 if it is not captured
+//! @param[in]  deadline mono_time_usec() by which the command must exit, or 0 for no limit
+//! @param[out] pOutput set to the stdout of the command if out_fd is a pipe
+//! @param[out] pError set to the stderr of the command if err_fd is a pipe
+//! @param[out] pExited set to TRUE if exit_fd became readable
+//!
+//! @return EUCA_OK, EUCA_TIMEOUT_ERROR if the deadline passed or EUCA_MEMORY_ERROR if the
+//!         output could not be stored
+//!
+static int gather_output(int exit_fd, int out_fd, int err_fd, long long deadline, char **pOutput, char **pError, boolean * pExited)
+{
+    int i = 0;
+    int rc = 0;
+    int nfds = 0;
+    int wait_ms = -1;
+    int ret = EUCA_OK;
+    int fds[2] = { out_fd, err_fd };
+    char **bufs[2] = { pOutput, pError };
+    size_t lens[2] = { 0, 0 };
+    boolean exited = FALSE;
+    struct pollfd pfds[3] = { {0} };
+
+    for (i = 0; i < 2; i++) {
+        if ((fds[i] >= 0) && ((*bufs[i] = EUCA_ZALLOC(1, sizeof(char))) == NULL))
+            ret = EUCA_MEMORY_ERROR;
+    }
+
+    while ((fds[0] >= 0) || (fds[1] >= 0) || ((exit_fd >= 0) && !exited)) {
+        nfds = 0;
+        for (i = 0; i < 2; i++) {
+            if (fds[i] >= 0) {
+                pfds[nfds].fd = fds[i];
+                pfds[nfds++].events = POLLIN;
+            }
+        }
+        if ((exit_fd >= 0) && !exited) {
+            pfds[nfds].fd = exit_fd;
+            pfds[nfds++].events = POLLIN;
+        }
+
+        if (deadline && ((wait_ms = (deadline - mono_time_usec()) / 1000) <= 0)) {
+            ret = EUCA_TIMEOUT_ERROR;
+            break;
+        }
+        if ((rc = poll(pfds, nfds, (deadline ? wait_ms : -1))) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGWARN("poll() failed on the output of a command: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int j = 0; (rc > 0) && (j < nfds); j++) {
+            if (pfds[j].revents == 0)
+                continue;
+            if (pfds[j].fd == exit_fd) {
+                exited = TRUE;
+                continue;
+            }
+            i = ((pfds[j].fd == fds[0]) ? 0 : 1);
+            if ((ret == EUCA_OK) && (append_output(bufs[i], &lens[i], fds[i]) > 0))
+                continue;
+            close(fds[i]);
+            fds[i] = -1;
+        }
+
+        // once the command is gone, take what is already in the pipes but do not wait for more
+        if (exited) {
+            for (i = 0; i < 2; i++) {
+                if (fds[i] < 0)
+                    continue;
+                fcntl(fds[i], F_SETFL, (fcntl(fds[i], F_GETFL) | O_NONBLOCK));
+                while ((ret == EUCA_OK) && (append_output(bufs[i], &lens[i], fds[i]) > 0)) ;
+                close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    (*pExited) = exited;
+    return (ret);
+}
+
+//!
+//! Gathers the output of a child and reaps it. The child's exit is noticed through a pidfd
+//! when the kernel has them (see gather_output()), so the timeout does not need a polling
+//! loop. On timeout, the process group of the child is killed.
+//!
+//! @param[in]  pid the child process
+//! @param[in]  out_fd the stdout pipe of the child or -1 if it is not captured
+//! @param[in]  err_fd the stderr pipe of the child or -1 if it is not captured
+//! @param[in]  timeout_sec how long the child may run, or 0 to wait for as long as it takes
+//! @param[out] pOutput set to the stdout of the child if out_fd is a pipe
+//! @param[out] pError set to the stderr of the child if err_fd is a pipe
+//! @param[out] pStatus set to the status from waitpid(), if not NULL
+//!
+//! @return EUCA_OK if the child exited with 0, EUCA_ERROR if it exited with another code,
+//!         EUCA_TIMEOUT_ERROR if it timed out, EUCA_THREAD_ERROR if it was killed by a signal
+//!         or EUCA_MEMORY_ERROR if its output could not be stored
+//!
+static int collect_child(pid_t pid, int out_fd, int err_fd, int timeout_sec, char **pOutput, char **pError, int *pStatus)
+{
+    int rc = 0;
+    int status = 0;
+    int pidfd = -1;
+    int ret = EUCA_OK;
+    boolean exited = FALSE;
+    boolean timed_out = FALSE;
+    long long deadline = ((timeout_sec > 0) ? (mono_time_usec() + (timeout_sec * 1000000LL)) : 0);
+
+#ifdef SYS_pidfd_open
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif /* SYS_pidfd_open */
+
+    if ((ret = gather_output(pidfd, out_fd, err_fd, deadline, pOutput, pError, &exited)) == EUCA_TIMEOUT_ERROR) {
+        timed_out = TRUE;
+        ret = EUCA_OK;
+    }
+    if (pidfd >= 0)
+        close(pidfd);
+
+    // without a pidfd, the pipes closing is all we know, so poll for the exit
+    while (!timed_out && ((rc = waitpid(pid, &status, (deadline ? WNOHANG : 0))) <= 0)) {
+        if ((rc < 0) && (errno != EINTR))
+            break;
+        if (deadline && (mono_time_usec() >= deadline))
+            timed_out = TRUE;
+        else if (rc == 0)
+            usleep(RUN_WAIT_USEC);
+    }
+
+    if (timed_out) {
+        LOGERROR("child process %d timed out after %d seconds, killing it\n", pid, timeout_sec);
+        kill(-pid, SIGKILL);
+        kill(pid, SIGKILL);
+        while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR)) ;
+        ret = EUCA_TIMEOUT_ERROR;
+    } else if (rc < 0) {
+        LOGERROR("failed to wait for child process %d: %s\n", pid, strerror(errno));
+        ret = EUCA_TIMEOUT_ERROR;
+    } else if (WIFSIGNALED(status)) {
+        LOGDEBUG("child process %d ended because of an uncaught signal. sig=%d\n", pid, WTERMSIG(status));
+        ret = EUCA_THREAD_ERROR;
+    } else if ((ret == EUCA_OK) && (WEXITSTATUS(status) != 0)) {
+        ret = EUCA_ERROR;
+    }
+
+    if (pStatus)
+        (*pStatus) = status;
+    return (ret);
+}
+
+//!
+//! Adds the duration of a command to its latency counters. Commands are counted under the
+//! name of the program that does the work, so "euca_rootwrap losetup ..." counts as losetup.
+//!
+//! @param[in] argv the NULL-terminated command line, or NULL if command is set
+//! @param[in] command the shell command line, or NULL if argv is set
+//! @param[in] usec how long the command took
+//! @param[in] result what the command returned
+//!
+static void run_stats_record(char *const argv[], const char *command, long long usec, int result)
+{
+    int i = 0;
+    char name[sizeof(run_stats[0].name)] = "";
+    char word[EUCA_MAX_PATH] = "";
+    const char *base = NULL;
+    euca_run_stats *stats = NULL;
+
+    // the first word that is not the rootwrap
+    for (i = 0; (argv && argv[i]) || (command && (i < 2)); i++) {
+        if (argv) {
+            euca_strncpy(word, argv[i], sizeof(word));
+        } else if (sscanf(command, ((i == 0) ? "%4095s" : "%*s %4095s"), word) != 1) {
+            break;
+        }
+        base = ((strrchr(word, '/') != NULL) ? (strrchr(word, '/') + 1) : word);
+        euca_strncpy(name, base, sizeof(name));
+        if (strcmp(base, "euca_rootwrap"))
+            break;
+    }
+
+    pthread_mutex_lock(&run_stats_mutex);
+    for (i = 0; (i < run_stats_len) && strcmp(run_stats[i].name, name); i++) ;
+    if ((i == run_stats_len) && (run_stats_len < RUN_STATS_MAX)) {
+        euca_strncpy(run_stats[run_stats_len++].name, name, sizeof(run_stats[i].name));
+    }
+    if (i < run_stats_len) {
+        stats = &run_stats[i];
+        stats->calls++;
+        stats->total_usec += usec;
+        if (usec > stats->max_usec)
+            stats->max_usec = usec;
+        if (result == EUCA_TIMEOUT_ERROR)
+            stats->timeouts++;
+        else if (result != EUCA_OK)
+            stats->failures++;
+    }
+    pthread_mutex_unlock(&run_stats_mutex);
+
+    LOGTRACE("'%s' took %lld usec (result %d)\n", name, usec, result);
+}
+
+//!
+//! Forgets the privileged helper of the parent in a forked child, so that the child neither
+//! shares the parent's connections nor keeps the helper alive after the parent is gone. The
+//! child may start a helper of its own.
+//!
+static void privd_forget(void)
+{
+    if (privd_control >= 0)
+        close(privd_control);
+    for (int i = 0; i < privd_pool_len; i++)
+        close(privd_pool[i]);
+    privd_control = -1;
+    privd_pool_len = 0;
+    privd_pid = -1;
+}
+
+//!
+//! Runs in the child after fork(). The parent's threads are gone, so the lock is reset rather
+//! than taken.
+//!
+static void privd_atfork_child(void)
+{
+    pthread_mutex_init(&privd_mutex, NULL);
+    privd_forget();
+}
+
+//!
+//! Registers privd_atfork_child(), once
+//!
+static void privd_init_atfork(void)
+{
+    pthread_atfork(NULL, NULL, privd_atfork_child);
+}
+
+//!
+//! Closes the control socket and the idle connections, which makes the privileged helper exit
+//! once its current commands complete. Must be called with privd_mutex held.
+//!
+static void privd_stop(void)
+{
+    if (privd_control >= 0)
+        close(privd_control);
+    for (int i = 0; i < privd_pool_len; i++)
+        close(privd_pool[i]);
+    privd_control = -1;
+    privd_pool_len = 0;
+    if (privd_pid > 0)
+        waitpid(privd_pid, NULL, WNOHANG);
+    privd_pid = -1;
+    privd_failed = mono_time_sec();
+}
+
+//!
+//! Starts the privileged helper, installed next to euca_rootwrap, through euca_rootwrap. Its
+//! stdin is the control socket. Must be called with privd_mutex held.
+//!
+//! @param[in] rootwrap the path of euca_rootwrap
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the helper is not installed or cannot be started
+//!
+static int privd_start(const char *rootwrap)
+{
+    extern char **environ;
+    int rc = 0;
+    int sv[2] = { -1, -1 };
+    char path[EUCA_MAX_PATH] = "";
+    char *argv[3] = { (char *)rootwrap, path, NULL };
+    const char *slash = strrchr(rootwrap, '/');
+    posix_spawn_file_actions_t actions = { 0 };
+    posix_spawnattr_t attr = { 0 };
+
+    snprintf(path, sizeof(path), "%.*s" EUCA_PRIVD_NAME, ((slash != NULL) ? ((int)(slash - rootwrap) + 1) : 0), rootwrap);
+    if (access(path, X_OK) != 0)
+        return (EUCA_ERROR);
+
+    if (socketpair(AF_UNIX, (SOCK_STREAM | SOCK_CLOEXEC), 0, sv) != 0) {
+        LOGWARN("socketpair() failed: %s\n", strerror(errno));
+        return (EUCA_ERROR);
+    }
+
+    // in a process group of its own, the helper does not get the signals meant for the component
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], STDIN_FILENO);
+    rc = posix_spawn(&privd_pid, rootwrap, &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(sv[1]);
+
+    if (rc != 0) {
+        LOGWARN("failed to start %s: %s\n", path, strerror(rc));
+        close(sv[0]);
+        privd_pid = -1;
+        return (EUCA_ERROR);
+    }
+
+    privd_control = sv[0];
+    privd_owner = getpid();
+    LOGINFO("started privileged helper %s (pid=%d)\n", path, privd_pid);
+    return (EUCA_OK);
+}
+
+//!
+//! Gets a connection to the privileged helper, starting the helper if needed. Each connection
+//! carries one command at a time; idle ones are kept for reuse.
+//!
+//! @param[in] rootwrap the path of euca_rootwrap, next to which the helper is installed
+//!
+//! @return the connection or -1 if the helper is not available
+//!
+static int privd_connect(const char *rootwrap)
+{
+    int conn = -1;
+    int sv[2] = { -1, -1 };
+    char control[CMSG_SPACE(sizeof(int))] = { 0 };
+    euca_privd_request req = { 0 };
+    struct iovec iov = { &req, sizeof(req) };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg = NULL;
+
+    pthread_once(&privd_once, privd_init_atfork);
+    pthread_mutex_lock(&privd_mutex);
+    if ((privd_control >= 0) && (privd_owner != getpid())) {
+        // forked without the atfork handler (e.g. by vfork)
+        privd_forget();
+    }
+
+    if ((privd_control < 0) && (!privd_failed || ((mono_time_sec() - privd_failed) >= PRIVD_RETRY_SEC)) && (privd_start(rootwrap) != EUCA_OK)) {
+        privd_failed = mono_time_sec();
+    }
+
+    if (privd_pool_len > 0) {
+        conn = privd_pool[--privd_pool_len];
+    } else if (privd_control >= 0) {
+        if (socketpair(AF_UNIX, (SOCK_STREAM | SOCK_CLOEXEC), 0, sv) == 0) {
+            // pass the other end of the new connection to the helper
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &sv[1], sizeof(int));
+
+            if (sendmsg(privd_control, &msg, MSG_NOSIGNAL) == sizeof(req)) {
+                conn = sv[0];
+            } else {
+                LOGWARN("privileged helper (pid=%d) is gone: %s\n", privd_pid, strerror(errno));
+                close(sv[0]);
+                privd_stop();
+            }
+            close(sv[1]);
+        }
+    }
+    pthread_mutex_unlock(&privd_mutex);
+    return (conn);
+}
+
+//!
+//! Returns a connection to the pool, or closes it
+//!
+//! @param[in] conn the connection
+//! @param[in] reuse FALSE if the connection is in an unknown state and must be closed
+//!
+static void privd_release(int conn, boolean reuse)
+{
+    pthread_mutex_lock(&privd_mutex);
+    if (reuse && (privd_owner == getpid()) && (privd_control >= 0) && (privd_pool_len < PRIVD_POOL_MAX)) {
+        privd_pool[privd_pool_len++] = conn;
+        conn = -1;
+    }
+    pthread_mutex_unlock(&privd_mutex);
+    if (conn >= 0)
+        close(conn);
+}
+
+//!
+//! Runs a command that starts with euca_rootwrap through the privileged helper, which saves
+//! the exec of euca_rootwrap and, for loop devices, device mapper and mounts, that of the
+//! command itself. Commands the helper does not allow are left to the caller to run.
+//!
+//! @param[in]  argv see euca_run()
+//! @param[in]  stdin_path see euca_run()
+//! @param[in]  flags see euca_run()
+//! @param[in]  timeout_sec see euca_run()
+//! @param[out] pOutput see euca_run()
+//! @param[out] pError see euca_run()
+//! @param[out] pStatus see euca_run()
+//! @param[out] pResult set to what euca_run() returns, if the command was run
+//!
+//! @return TRUE if the helper ran the command or FALSE if the caller must run it
+//!
+static boolean privd_run(char *const argv[], const char *stdin_path, int flags, int timeout_sec, char **pOutput, char **pError, int *pStatus, int *pResult)
+{
+    int i = 0;
+    int nfds = 0;
+    int conn = -1;
+    int len = 0;
+    int pipes[2][2] = { {-1, -1}, {-1, -1} };
+    int fds[2] = { -1, -1 };
+    char payload[PRIVD_MAX_PAYLOAD] = "";
+    char control[CMSG_SPACE(sizeof(int) * 2)] = { 0 };
+    const char *base = ((strrchr(argv[0], '/') != NULL) ? (strrchr(argv[0], '/') + 1) : argv[0]);
+    boolean exited = FALSE;
+    boolean reuse = FALSE;
+    long long deadline = 0;
+    ssize_t bytes = 0;
+    euca_privd_request req = { 0 };
+    euca_privd_reply reply = { 0 };
+    struct iovec iov = { &req, sizeof(req) };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg = NULL;
+    struct pollfd pfd = { 0 };
+
+    if (strcmp(base, "euca_rootwrap") || (argv[1] == NULL) || (stdin_path && (stdin_path[0] != '/')))
+        return (FALSE);
+
+    // the arguments after euca_rootwrap, then the stdin path
+    for (i = 1; argv[i] && (len < PRIVD_MAX_PAYLOAD); i++)
+        len += snprintf(payload + len, (PRIVD_MAX_PAYLOAD - len), "%s", argv[i]) + 1;
+    if (len < PRIVD_MAX_PAYLOAD)
+        len += snprintf(payload + len, (PRIVD_MAX_PAYLOAD - len), "%s", (stdin_path ? stdin_path : "")) + 1;
+    if ((len > PRIVD_MAX_PAYLOAD) || ((i - 1) > PRIVD_MAX_ARGS))
+        return (FALSE);
+
+    req.nargs = (i - 1);
+    req.timeout_sec = timeout_sec;
+    req.len = len;
+    if (pOutput) {
+        req.fds |= PRIVD_FD_STDOUT;
+        if (flags & EUCA_RUN_MERGE_STDERR)
+            req.fds |= PRIVD_FD_STDERR;
+    }
+    if (pError && !(req.fds & PRIVD_FD_STDERR)) {
+        req.fds |= PRIVD_FD_STDERR;
+    }
+    if ((pOutput && (pipe2(pipes[0], O_CLOEXEC) != 0)) || ((pError && !(pOutput && (flags & EUCA_RUN_MERGE_STDERR))) && (pipe2(pipes[1], O_CLOEXEC) != 0))
+        || ((conn = privd_connect(argv[0])) < 0)) {
+        for (i = 0; i < 4; i++) {
+            if (pipes[i / 2][i % 2] >= 0)
+                close(pipes[i / 2][i % 2]);
+        }
+        return (FALSE);
+    }
+    if (req.fds & PRIVD_FD_STDOUT)
+        fds[nfds++] = pipes[0][1];
+    if (req.fds & PRIVD_FD_STDERR)
+        fds[nfds++] = ((pipes[1][1] >= 0) ? pipes[1][1] : pipes[0][1]);
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, (sizeof(int) * nfds));
+    }
+
+    // the helper checks the command before running it, so a denial or a dead helper leaves it unrun
+    pfd.fd = conn;
+    pfd.events = POLLIN;
+    if ((sendmsg(conn, &msg, MSG_NOSIGNAL) != sizeof(req)) || (send(conn, payload, len, MSG_NOSIGNAL) != len)
+        || (poll(&pfd, 1, (PRIVD_GRACE_SEC * 1000)) != 1) || (read(conn, &reply, sizeof(reply)) != sizeof(reply))) {
+        LOGWARN("privileged helper (pid=%d) did not answer, running '%s' with euca_rootwrap\n", privd_pid, argv[1]);
+        reply.type = 0;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (pipes[i][1] >= 0)
+            close(pipes[i][1]);
+    }
+
+    if (reply.type != PRIVD_ACCEPTED) {
+        for (i = 0; i < 2; i++) {
+            if (pipes[i][0] >= 0)
+                close(pipes[i][0]);
+        }
+        privd_release(conn, (reply.type == PRIVD_DENIED));
+        if (reply.type != PRIVD_DENIED) {
+            pthread_mutex_lock(&privd_mutex);
+            if (privd_owner == getpid())
+                privd_stop();
+            pthread_mutex_unlock(&privd_mutex);
+        }
+        return (FALSE);
+    }
+
+    log_argv(privd_pid, argv + 1);
+    deadline = ((timeout_sec > 0) ? (mono_time_usec() + ((timeout_sec + PRIVD_GRACE_SEC) * 1000000LL)) : 0);
+    (*pResult) = gather_output(conn, pipes[0][0], pipes[1][0], deadline, pOutput, pError, &exited);
+
+    // the helper enforces the timeout, and sends the result once the command is done
+    if (exited && ((bytes = read(conn, &reply, sizeof(reply))) == sizeof(reply)) && (reply.type == PRIVD_DONE)) {
+        if ((*pResult) == EUCA_OK)
+            (*pResult) = reply.result;
+        if (pStatus)
+            (*pStatus) = reply.status;
+        reuse = TRUE;
+    } else if ((*pResult) == EUCA_TIMEOUT_ERROR) {
+        LOGERROR("privileged helper (pid=%d) did not complete '%s' in %d seconds\n", privd_pid, argv[1], timeout_sec);
+    } else {
+        LOGERROR("privileged helper (pid=%d) went away while running '%s'\n", privd_pid, argv[1]);
+        (*pResult) = EUCA_THREAD_ERROR;
+    }
+
+    privd_release(conn, reuse);
+    return (TRUE);
+}
+
+//!
+//! Runs a command without a shell, capturing its output in memory, and waits for it to
+//! complete. Prefer this to system(), popen() and fork()/exec(): the child is started with
+//! posix_spawn(), which does not copy the caller's page tables.
+//!
+//! @param[in]  argv the NULL-terminated command line; argv[0] is looked up in $PATH
+//! @param[in]  stdin_path if not NULL, the file the command reads its stdin from
+//! @param[in]  flags EUCA_RUN_MERGE_STDERR to capture stderr along with stdout, as with 2>&1
+//! @param[in]  timeout_sec how long the command may run before it is killed, or 0 for no limit
+//! @param[out] pOutput if not NULL, set to the stdout of the command, which the caller must free.
+//!             Otherwise, stdout is inherited.
+//! @param[out] pError if not NULL, set to the stderr of the command, which the caller must free.
+//!             Otherwise, stderr is inherited unless merged with stdout.
+//! @param[out] pStatus if not NULL, set to the status from waitpid()
+//!
+//! @return EUCA_OK if the command exited with 0 or the following error codes on failure:
+//!         \li EUCA_ERROR if the command exited with another code
+//!         \li EUCA_INVALID_ERROR if the provided argument does not meet the pre-requirements
+//!         \li EUCA_THREAD_ERROR if the command could not be started or was killed by a signal
+//!         \li EUCA_TIMEOUT_ERROR if the command timed out and was killed
+//!         \li EUCA_MEMORY_ERROR if the output could not be stored
+//!
+//! @note the output of the command is set even when it fails, so that it can be logged
+//!
+int euca_run(char *const argv[], const char *stdin_path, int flags, int timeout_sec, char **pOutput, char **pError, int *pStatus)
+{
+    int ret = EUCA_OK;
+    int out_fd = -1;
+    int err_fd = -1;
+    pid_t pid = -1;
+    long long start = mono_time_usec();
+
+    if (pOutput)
+        (*pOutput) = NULL;
+    if (pError)
+        (*pError) = NULL;
+    if (pStatus)
+        (*pStatus) = -1;
+
+    if ((argv == NULL) || (argv[0] == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if (privd_run(argv, stdin_path, flags, timeout_sec, pOutput, pError, pStatus, &ret)) {
+        // done by the privileged helper
+    } else if ((ret = spawn_child(&pid, argv, stdin_path, NULL, (pOutput ? &out_fd : NULL), (pError ? &err_fd : NULL), flags)) == EUCA_OK) {
+        ret = collect_child(pid, out_fd, err_fd, timeout_sec, pOutput, pError, pStatus);
+    } else {
+        ret = EUCA_THREAD_ERROR;
+    }
+
+    run_stats_record(argv, NULL, (mono_time_usec() - start), ret);
+    return (ret);
+}
+
+//!
+//! Runs a shell command line with euca_run(). Use it only when the command needs the
+//! shell (pipes, redirections, globbing): it costs an extra exec of /bin/sh.
+//!
+//! @param[in]  command the command line passed to 'sh -c'
+//! @param[in]  flags see euca_run()
+//! @param[in]  timeout_sec see euca_run()
+//! @param[out] pOutput see euca_run()
+//! @param[out] pError see euca_run()
+//! @param[out] pStatus see euca_run()
+//!
+//! @return see euca_run()
+//!
+int euca_run_shell(const char *command, int flags, int timeout_sec, char **pOutput, char **pError, int *pStatus)
+{
+    int ret = EUCA_OK;
+    int out_fd = -1;
+    int err_fd = -1;
+    pid_t pid = -1;
+    int i = 0;
+    long long start = mono_time_usec();
+    char *argv[] = { "/bin/sh", "-c", (char *)command, NULL };
+    char *copy = NULL;
+    char *word = NULL;
+    char *saveptr = NULL;
+    char *words[PRIVD_MAX_ARGS + 1] = { NULL };
+    boolean routed = FALSE;
+
+    if (pOutput)
+        (*pOutput) = NULL;
+    if (pError)
+        (*pError) = NULL;
+    if (pStatus)
+        (*pStatus) = -1;
+
+    if (command == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    // a rootwrap'ed command line that needs nothing from the shell can go to the privileged helper
+    if ((strpbrk(command, PRIVD_SHELL_CHARS) == NULL) && ((copy = strdup(command)) != NULL)) {
+        for (i = 0, word = strtok_r(copy, " \t", &saveptr); word && (i < PRIVD_MAX_ARGS); word = strtok_r(NULL, " \t", &saveptr))
+            words[i++] = word;
+        words[i] = NULL;
+        routed = ((word == NULL) && (i > 1) && privd_run(words, NULL, flags, timeout_sec, pOutput, pError, pStatus, &ret));
+        EUCA_FREE(copy);
+    }
+
+    if (routed) {
+        // done by the privileged helper
+    } else if ((ret = spawn_child(&pid, argv, NULL, NULL, (pOutput ? &out_fd : NULL), (pError ? &err_fd : NULL), flags)) == EUCA_OK) {
+        ret = collect_child(pid, out_fd, err_fd, timeout_sec, pOutput, pError, pStatus);
+    } else {
+        ret = EUCA_THREAD_ERROR;
+    }
+
+    run_stats_record(NULL, command, (mono_time_usec() - start), ret);
+    return (ret);
+}
+
+//!
+//! Returns a copy of the latency counters of the commands run with euca_run(),
+//! euca_run_shell() and the functions built on them
+//!
+//! @param[out] ppStats set to an array of counters, which the caller must free
+//! @param[out] pLen set to the number of entries in the array
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR on failure
+//!
+int euca_run_stats_get(euca_run_stats ** ppStats, int *pLen)
+{
+    int ret = EUCA_OK;
+
+    *ppStats = NULL;
+    *pLen = 0;
+
+    pthread_mutex_lock(&run_stats_mutex);
+    if (run_stats_len > 0) {
+        if ((*ppStats = EUCA_ZALLOC(run_stats_len, sizeof(euca_run_stats))) != NULL) {
+            memcpy(*ppStats, run_stats, (run_stats_len * sizeof(euca_run_stats)));
+            *pLen = run_stats_len;
+        } else {
+            ret = EUCA_MEMORY_ERROR;
+        }
+    }
+    pthread_mutex_unlock(&run_stats_mutex);
+    return (ret);
 }
 
 //!
 //! Eucalyptus wrapper function around exec with file-descriptor support and argv[]
 //!
-//! This is the low-level function that actually sets up file descriptors, forks,
-//! and calls execvp(). The function does not wait for the child process to finish:
+//! This is the low-level function that actually sets up file descriptors and spawns
+//! the program with posix_spawnp(). The function does not wait for the child process to finish:
 //! that can and probably should be done with the complementary low-level function:
 //! euca_waitpid().  Consider higher-level alternatives, too:
 //!
@@ -2025,88 +2998,8 @@ void log_argv(char **argv)
 //!
 int euca_execvp_fd(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, char **argv)
 {
-    int result = 0;
-    int stdin_p[2];
-    int stdout_p[2];
-    int stderr_p[2];
-
     assert(ppid);
-    *ppid = -1;
-
-    // set up the pipes, if requested
-    if (stdin_fd) {
-        *stdin_fd = -1;
-        if (pipe(stdin_p) != 0) {
-            LOGERROR("pipe() failed\n");
-            return (EUCA_ERROR);
-        }
-    }
-    if (stdout_fd) {
-        *stdout_fd = -1;
-        if (pipe(stdout_p) != 0) {
-            LOGERROR("pipe() failed: %s\n", strerror(errno));
-            return (EUCA_ERROR);
-        }
-    }
-    if (stderr_fd) {
-        *stderr_fd = -1;
-        if (pipe(stderr_p) != 0) {
-            LOGERROR("pipe() failed: %s\n", strerror(errno));
-            return (EUCA_ERROR);
-        }
-    }
-    // Fork the work
-    if ((*ppid = fork()) == -1) {
-        LOGDEBUG("failed to create a child process\n");
-        return (EUCA_THREAD_ERROR);
-    }
-    // child?
-    if (*ppid == 0) {
-        setpgid(0,0);
-        // arrange the file descriptors
-        if (stdin_fd) {
-            close(stdin_p[1]);
-            if (dup2(stdin_p[0], STDIN_FILENO) == -1) {
-                LOGERROR("dup2() failed: %s\n", strerror(errno));
-                exit(1);
-            }
-        }
-        if (stdout_fd) {
-            close(stdout_p[0]);
-            if (dup2(stdout_p[1], STDOUT_FILENO) == -1) {
-                LOGERROR("dup2() failed: %s\n", strerror(errno));
-                exit(1);
-            }
-        }
-        if (stderr_fd) {
-            close(stderr_p[0]);
-            if (dup2(stderr_p[1], STDERR_FILENO) == -1) {
-                LOGERROR("dup2() failed: %s\n", strerror(errno));
-                exit(1);
-            }
-        }
-        // print the command we are about to execute
-        log_argv(argv);
-
-        // Run the command. This should never return unless a failure occured
-        result = execvp(argv[0], argv);
-        exit(result);
-    }
-    // close the file descriptors on the parent appropriately
-    if (stdin_fd) {
-        close(stdin_p[0]);
-        *stdin_fd = stdin_p[1];
-    }
-    if (stdout_fd) {
-        close(stdout_p[1]);
-        *stdout_fd = stdout_p[0];
-    }
-    if (stderr_fd) {
-        close(stderr_p[1]);
-        *stderr_fd = stderr_p[0];
-    }
-
-    return EUCA_OK;
+    return (spawn_child(ppid, argv, NULL, stdin_fd, stdout_fd, stderr_fd, 0));
 }
 
 //!
@@ -2239,11 +3132,7 @@ int euca_execlp(int *pStatus, const char *file, ...)
             return EUCA_INVALID_ERROR;
     }
 
-    pid_t pid;
-    result = euca_execvp_fd(&pid, NULL, NULL, NULL, argv);
-    if (result == EUCA_OK) {
-        result = euca_waitpid(pid, pStatus);
-    }
+    result = euca_run(argv, NULL, 0, 0, NULL, NULL, pStatus);
     free_char_list(argv);
 
     return result;
@@ -2428,11 +3317,13 @@ int euca_execlp_log(int *pStatus, int (*custom_parser) (const char *line, void *
 
     pid_t pid;
     int child_fds[2];
+    long long start = mono_time_usec();
     result = euca_execvp_fd(&pid, NULL, &child_fds[0], &child_fds[1], argv);
     if (result == EUCA_OK) {
         log_fds(2, child_fds, custom_parser, parser_data);
         result = euca_waitpid(pid, pStatus);
     }
+    run_stats_record(argv, NULL, (mono_time_usec() - start), result);
     free_char_list(argv);
 
     return result;
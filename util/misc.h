@@ -104,6 +104,10 @@
 
 #define NANOSECONDS_IN_SECOND           1000000000  //!< constant for conversion
 
+#define EUCA_RUN_MERGE_STDERR                   0x01    //!< euca_run() flag to capture stderr along with stdout, as with 2>&1
+
+#define XML_CURSOR_DEPTH                          64    //!< most nested elements an xml_cursor follows
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -127,6 +131,44 @@ typedef unsigned char boolean;         //!< @todo move this somewhere more globa
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Latency counters of a command run with euca_run() and friends
+typedef struct euca_run_stats_t {
+    char name[64];                     //!< the program, without its path
+    long long calls;                   //!< how many times it was run
+    long long failures;                //!< how many of those did not exit with 0, timeouts aside
+    long long timeouts;                //!< how many of those were killed for running too long
+    long long total_usec;              //!< total time spent running it
+    long long max_usec;                //!< longest run
+} euca_run_stats;
+
+//! A part of an XML document, not NUL-terminated
+typedef struct xml_slice_t {
+    const char *start;                 //!< first character, or NULL if the slice is unset
+    int len;                           //!< number of characters
+} xml_slice;
+
+//! An element of an XML document, as returned by xml_cursor_next()
+typedef struct xml_element_t {
+    const char *path;                  //!< lower-case xpath of the element, e.g. "a/c/e", valid until the next call
+    int depth;                         //!< number of elements the element is in, 0 for the root
+    xml_slice name;                    //!< name of the element, as written
+    xml_slice content;                 //!< what is between its opening and closing tags
+} xml_element;
+
+//! A single pass over an XML document, which yields its elements as they close
+typedef struct xml_cursor_t {
+    const char *xml;                   //!< the document
+    int offset;                        //!< where in the document the scan resumes
+    int depth;                         //!< number of open elements
+    boolean closed;                    //!< set when the last element yielded is still on the path
+    boolean error;                     //!< set once the document turned out to be malformed
+    xml_slice names[XML_CURSOR_DEPTH]; //!< names of the open elements
+    const char *contents[XML_CURSOR_DEPTH]; //!< where the content of each open element starts
+    int path_lens[XML_CURSOR_DEPTH];   //!< length of the path of the parent of each open element
+    int path_len;                      //!< length of path
+    char path[EUCA_MAX_PATH];          //!< lower-case xpath of the innermost open element
+} xml_cursor;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -169,10 +211,20 @@ int safekill(pid_t pid, char *procname, int sig, char *rootwrap);
 int maxint(int a, int b);
 int minint(int a, int b);
 char *xpath_content(const char *xml, const char *xpath);
+int xpath_extract(const char *xml, const char **xpaths, int nxpaths, xml_slice * slices);
+void xml_cursor_init(xml_cursor * cursor, const char *xml);
+int xml_cursor_next(xml_cursor * cursor, xml_element * element);
+char *xml_slice_dup(const xml_slice * slice);
 int construct_uri(char *uri, char *uriType, char *host, int port, char *path);
 int tokenize_uri(char *uri, char *uriType, char *host, int *port, char *path);
 long long time_usec(void);
 long long time_ms(void);
+long long mono_time_nsec(void);
+long long mono_time_usec(void);
+long long mono_time_ms(void);
+time_t mono_time_sec(void);
+long long fast_ticks(void);
+long long fast_ticks_usec(long long ticks);
 int get_blkid(const char *dev_path, char *uuid, unsigned int uuid_size);
 char parse_boolean(const char *s);
 int drop_privs(void);
@@ -186,6 +238,9 @@ int euca_execlp_fd(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd,
 int euca_execlp(int *pStatus, const char *file, ...);
 int euca_run_workflow_parser(const char *line, void *data);
 int euca_execlp_log(int *pStatus, int (*custom_parser) (const char *line, void *data), void *parser_data, const char *file, ...);
+int euca_run(char *const argv[], const char *stdin_path, int flags, int timeout_sec, char **pOutput, char **pError, int *pStatus);
+int euca_run_shell(const char *command, int flags, int timeout_sec, char **pOutput, char **pError, int *pStatus);
+int euca_run_stats_get(euca_run_stats ** ppStats, int *pLen);
 char *get_username(void);
 int euca_nanosleep(unsigned long long nsec);
 void euca_srand(void);
@@ -85,6 +85,8 @@
 #include <pthread.h>
 #include <assert.h>
 #include <errno.h>
+#include <sched.h>
+#include <sys/stat.h>                  // mkdir, chmod
 
 #include "eucalyptus.h"
 #include "misc.h"
@@ -101,6 +103,30 @@
 
 #define MAX_SENSOR_RESOURCES                     MAXINSTANCES_PER_CC    //!< used for resource name cache
 #define SENSOR_SYSTEM_POLL_INTERVAL_MINIMUM_USEC 5000000    //!< never poll system more often than this
+#define SENSOR_BATCH_MAGIC                       "SB1"  //!< first token of a batch of sensor resources, with the version of the encoding
+#define SENSOR_CURSORS_MAGIC                     "SC1"  //!< first token of the cursors that go with a batch request
+#define SENSOR_BATCH_MAX_INT                     1e15   //!< values below this that are integers are sent as deltas
+#define SENSOR_TEXT_INITIAL_SIZE                 4096   //!< initial size of batches and cursors being encoded
+#define SENSOR_DICT_INCREMENT                    64     //!< names by which to grow a batch or cursors dictionary
+
+#ifdef _BENCHMARK
+#define BENCH_DEFAULT_RESOURCES                  "16,64,256"
+#define BENCH_DEFAULT_HISTORY                    "5,15"
+#define BENCH_DEFAULT_METRICS                    8  //!< metrics of every resource, as for an instance with a disk and a network interface
+#define BENCH_DEFAULT_DIMENSIONS                 3  //!< dimensions of every metric, e.g. root, ephemeral0 and one volume
+#define BENCH_DEFAULT_WRITERS                    2
+#define BENCH_DEFAULT_READERS                    4
+#define BENCH_DEFAULT_MERGERS                    1
+#define BENCH_DEFAULT_OPS                        20000  //!< calls by every thread of the concurrent phase
+#define BENCH_MAX_LIST                           16
+#define BENCH_MAX_THREADS                        64
+#define BENCH_MAX_RESOURCES                      (SENSOR_INDEX_SIZE / 2)    //!< the most that init_state() allows
+#define BENCH_INTERVAL_MS                        20000L //!< collection interval, which also sets the expiration timeout
+#define BENCH_READS_PER_RESOURCE                 4  //!< single-resource reads, per resource, in the serial phase
+#define BENCH_POLLS                              20 //!< full-cache reads, encodings, merges and refreshes per configuration
+#define BENCH_SCANS                              100    //!< expiration passes that find nothing to expire
+#define BENCH_EXPIRATIONS                        5  //!< expiration passes that expire the whole cache
+#endif /* _BENCHMARK */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -108,29 +134,84 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Growable string of a batch or cursors being encoded
+typedef struct sensorText_t {
+    char *buf;
+    int len;
+    int size;
+} sensorText;
+
+//! Name dictionary of a batch or cursors being encoded
+typedef struct sensorDict_t {
+    const char **names;                //!< the names, pointing to the resources being encoded
+    int namesLen;
+    int namesSize;
+    sensorText text;                   //!< the names, one per line, in the order of their indexes
+    int error;                         //!< EUCA_OK or why a name could not be added
+} sensorDict;
+
+//! Cursor of a dimension, names being dictionary indexes
+typedef struct sensorCursor_t {
+    int metric;
+    int type;
+    int dimension;
+    long long nextSeq;                 //!< sequence number of the first value the CC does not have
+} sensorCursor;
+
+//! Cursors of a resource
+typedef struct sensorCursorGroup_t {
+    int resource;                      //!< dictionary index of the name of the resource
+    int first;                         //!< index of the first cursor of the resource
+    int count;                         //!< number of cursors of the resource
+} sensorCursorGroup;
+
+#ifdef _BENCHMARK
+//! Latencies of one benchmarked operation
+typedef struct _bench_samples {
+    long long *usec;                   //!< latency of every successful call, in microseconds
+    int len;                           //!< number of entries in usec[]
+    int size;                          //!< room in usec[]
+    int failed;                        //!< number of failed calls
+    long long elapsed_usec;            //!< wall-clock time of the phase, for the throughput
+} bench_samples;
+
+//! Thread of the concurrent phase of the benchmark
+typedef struct _bench_worker {
+    pthread_t thread;
+    boolean started;
+    int role;                          //!< one of the bench_role values
+    int slice;                         //!< writers and mergers only update the resources 'r' for which (r % slices) == slice
+    int slices;
+    int values;                        //!< values of every dimension in a merged record
+    int ops;                           //!< number of calls to make
+    unsigned int seed;                 //!< rand_r() state
+    sensorResource **srs;              //!< records read or merged by this thread
+    int srsLen;
+    bench_samples s;
+} bench_worker;
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#ifdef _BENCHMARK
+//! What a thread of the concurrent phase of the benchmark does
+enum bench_role {
+    BENCH_WRITER,                      //!< adds values one at a time, like the sensor bottom half
+    BENCH_READER,                      //!< reads single resources, like the sensor requests of the CC
+    BENCH_MERGER,                      //!< merges whole records, like the CC does with the data of its NCs
+};
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-//! an internal struct for temporary storage of stats
-typedef struct getstat_t {
-    char instanceId[100];
-    long long timestamp;
-    char metricName[100];
-    int counterType;
-    char dimensionName[100];
-    double value;
-    struct getstat_t *next;
-} getstat;
-
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -150,6 +231,9 @@ const char *euca_this_component_name = "ignore";
 const char *euca_client_component_name = "ignore";
 #endif /* _UNIT_TEST */
 
+//! Slab of the resource records decoded from the batches the CC polls from every NC
+euca_slab sensor_resource_slab = EUCA_SLAB_INITIALIZER("sensorResource", sensorResource, SENSOR_RESOURCE_SLAB_MAX_FREE);
+
 //! Sensor counter type names matching the enum
 const char *sensorCounterTypeName[] = {
     "[unused]",
@@ -169,8 +253,15 @@ static sensorResourceCache *sensor_state = NULL;
 static sem *state_sem = NULL;
 static sem *hyp_sem = NULL;
 static int (*sensor_update_euca_config) (void) = NULL;
+static sensorStatsCollector stats_collector = NULL;
 static long long seq_num = 0L;
 
+//! Length of the periods of each rollup tier
+static const long long sensor_rollup_period_ms[SENSOR_ROLLUP_TIERS] = {
+    60000L,                            // SENSOR_ROLLUP_1MIN
+    300000L,                           // SENSOR_ROLLUP_5MIN
+};
+
 #ifdef _UNIT_TEST
 static long long ts = 0;
 static void *competitor_function_writer(void *ptr);
@@ -179,6 +270,22 @@ static long long _sn = -1;
 static double val = 0.0;
 #endif /* _UNIT_TEST */
 
+#ifdef _BENCHMARK
+//! Metrics of the benchmark resources, the first of them being an average and the others summations
+static const char *bench_metrics[] = {
+    "CPUUtilization", "NetworkIn", "NetworkOut", "NetworkPacketsIn", "NetworkPacketsOut", "DiskReadOps",
+    "DiskWriteOps", "DiskReadBytes", "DiskWriteBytes", "VolumeTotalReadTime", "VolumeTotalWriteTime", "VolumeQueueLength",
+};
+
+static char (*bench_names)[MAX_SENSOR_NAME_LEN] = NULL;    //!< names of the benchmark resources
+static char (*bench_aliases)[MAX_SENSOR_NAME_LEN] = NULL;  //!< their (empty) aliases, for sensor_refresh_resources()
+static long long *bench_seq = NULL;    //!< sequence number of the next value of every resource
+static int bench_resources = 0;        //!< number of resources in the configuration being benchmarked
+static int bench_metrics_len = 0;
+static int bench_dimensions = 0;
+static long long bench_ts0 = 0;        //!< timestamp of the values with sequence number 0, in milliseconds
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -188,12 +295,30 @@ static double val = 0.0;
 static void getstat_free(getstat ** stats);
 static getstat *getstat_find(getstat ** stats, const char *instanceId);
 static int getstat_ninstances(getstat ** stats);
+static int getstat_parse(char *output, getstat *** pstats);
 static int getstat_generate(getstat *** pstats);
+static int getstat_merge(getstat ** stats, char resourceNames[][MAX_SENSOR_NAME_LEN], char resourceAliases[][MAX_SENSOR_NAME_LEN], int size, int *nmissing);
 static void sensor_bottom_half(void);
 static void *sensor_thread(void *arg);
 static void init_state(int resources_size);
 static __inline__ boolean is_empty_sr(const sensorResource * sr);
+static __inline__ void sensor_write_begin(volatile unsigned int *seq);
+static __inline__ void sensor_write_end(volatile unsigned int *seq);
+static const char *sensor_index_key(int idx, const sensorResource * sr);
+static int sensor_index_bucket(const char *key);
+static void sensor_index_insert(int idx, int slot);
+static void sensor_index_remove(int idx, int slot);
+static int sensor_index_find(int idx, const char *key);
+static boolean sensor_lookup_nolock(const char *name, boolean by_alias, int *slot);
+static void sensor_copy_sr(const sensorResource * sr, sensorResource * out);
+static int sensor_read_latest(const sensorResource * sr, const char *metricName, const int counterType, const char *dimensionName, long long *sequenceNum,
+                              long long *timestampMs, boolean * available, double *value, long long *intervalMs, int *valLen);
 static int sensor_expire_cache_entries(void);
+static int sensor_text_append(sensorText * text, const char *format, ...) _attribute_format_(2, 3);
+static int sensor_dict_index(sensorDict * dict, const char *name);
+static char *sensor_next_line(char **pos);
+static int sensor_parse_header(char **pos, const char *magic, char ***names, int *namesLen, int *count);
+static boolean sensor_parse_ll(char **pos, long long *val);
 #ifdef _UNIT_TEST
 static void log_sensor_resources(const char *name, sensorResource ** srs, int srsLen);
 #endif /* _UNIT_TEST */
@@ -201,6 +326,8 @@ static sensorResource *find_or_alloc_sr(const boolean do_alloc, const char *reso
 static sensorMetric *find_or_alloc_sm(const boolean do_alloc, sensorResource * sr, const char *metricName);
 static sensorCounter *find_or_alloc_sc(const boolean do_alloc, sensorMetric * sm, const sensorCounterType counterType);
 static sensorDimension *find_or_alloc_sd(const boolean do_alloc, sensorCounter * sc, const char *dimensionName);
+static sensorRollupSeries *sensor_rollup_series(sensorResource * sr, sensorDimension * sd, const boolean do_alloc);
+static void sensor_rollup_add(sensorRollupSeries * series, const sensorValue * sv);
 
 #ifdef _UNIT_TEST
 static void dump_sensor_cache(void);
@@ -209,6 +336,27 @@ static void *competitor_function_reader(void *ptr);
 static void *competitor_function_writer(void *ptr);
 #endif /* _UNIT_TEST */
 
+#ifdef _BENCHMARK
+static long long bench_usec(void);
+static void bench_add(bench_samples * s, long long usec, int ok);
+static void bench_merge(bench_samples * to, bench_samples * from);
+static int bench_compare(const void *a, const void *b);
+static void bench_report(FILE * out, const char *op, const char *config, int threads, bench_samples * s);
+static int bench_parse_list(const char *list, int *values, int size);
+static void bench_dimension(int d, char *name, int len);
+static int bench_counter_type(int m);
+static int bench_write_round(int r, bench_samples * s);
+static void bench_fill_record(int r, int values, sensorResource * sr);
+static int bench_collector(getstat *** pstats);
+static void *bench_worker_thread(void *ptr);
+static sensorResource **bench_alloc_srs(int len);
+static void bench_free_srs(sensorResource ** srs, int len);
+static int bench_stub_rootwrap(char *dir, int len);
+static void bench_remove_stub(const char *dir);
+static int bench_configuration(FILE * out, int resources, int history, int writers, int readers, int mergers, int ops);
+static int do_benchmark(int argc, char **argv);
+#endif /* _BENCHMARK */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -288,19 +436,61 @@ static int getstat_ninstances(getstat ** stats)
 }
 
 //!
-//! Adds all values in a linked list to sensor memory
+//! Puts all values in a linked list into a carrier record of their resource, so that
+//! sensor_merge_records() adds the values of all resources with one acquisition of the
+//! lock. A dimension gets the first of the values the list has for it.
 //!
-//! @param[in] name
-//! @param[in] head of a linked list of getstat values
+//! @param[in]     name of the resource
+//! @param[in]     head of a linked list of getstat values, may be NULL
+//! @param[in,out] sr the carrier, zeroed before the first list of the resource
 //!
-//! @return number of values added
+//! @return number of values put into the carrier
 //!
-static int getstat_add_values(const char *name, getstat * head)
+static int getstat_fill_sr(const char *name, getstat * head, sensorResource * sr)
 {
+    int m = 0;
+    int c = 0;
+    int d = 0;
     int nvalues = 0;
+    sensorMetric *sm = NULL;
+    sensorCounter *sc = NULL;
+    sensorDimension *sd = NULL;
+
+    if (sr->resourceName[0] == '\0') {
+        euca_strncpy(sr->resourceName, name, sizeof(sr->resourceName));
+        euca_strncpy(sr->resourceType, "instance", sizeof(sr->resourceType));
+    }
 
     for (getstat * s = head; s != NULL; s = s->next) {
-        sensor_add_value(name, s->metricName, s->counterType, s->dimensionName, seq_num, s->timestamp, TRUE, s->value);
+        for (m = 0; (m < sr->metricsLen) && strcmp(sr->metrics[m].metricName, s->metricName); m++) ;
+        if (m == sr->metricsLen) {
+            if (m == MAX_SENSOR_METRICS)
+                continue;
+            euca_strncpy(sr->metrics[m].metricName, s->metricName, sizeof(sr->metrics[m].metricName));
+            sr->metricsLen++;
+        }
+        sm = sr->metrics + m;
+
+        for (c = 0; (c < sm->countersLen) && (sm->counters[c].type != s->counterType); c++) ;
+        if (c == sm->countersLen) {
+            if (c == MAX_SENSOR_COUNTERS)
+                continue;
+            sm->counters[c].type = s->counterType;
+            sm->countersLen++;
+        }
+        sc = sm->counters + c;
+
+        for (d = 0; (d < sc->dimensionsLen) && strcmp(sc->dimensions[d].dimensionName, s->dimensionName); d++) ;
+        if ((d < sc->dimensionsLen) || (d == MAX_SENSOR_DIMENSIONS))
+            continue;
+        sd = sc->dimensions + d;
+        euca_strncpy(sd->dimensionName, s->dimensionName, sizeof(sd->dimensionName));
+        sd->sequenceNum = seq_num;
+        sd->values[0].timestampMs = s->timestamp;
+        sd->values[0].value = s->value;
+        sd->values[0].available = TRUE;
+        sd->valuesLen = 1;
+        sc->dimensionsLen++;
         nvalues++;
     }
 
@@ -308,7 +498,147 @@ static int getstat_add_values(const char *name, getstat * head)
 }
 
 //!
-//! obtain stats from the getstats script
+//! Appends a value to the list of the given instance in the stats array,
+//! expanding the NULL-terminated array when this is the first value seen
+//! for the instance.
+//!
+//! @param[in,out] pstats pointer to the stats array (may point to NULL)
+//! @param[in] instanceId the instance (or address) the value belongs to
+//! @param[in] timestamp timestamp of the measurement in milliseconds
+//! @param[in] metricName e.g. "CPUUtilization"
+//! @param[in] counterType one of the sensorCounterType values
+//! @param[in] dimensionName e.g. "default" or "vda"
+//! @param[in] value the measurement
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include: EUCA_INVALID_ERROR
+//!         and EUCA_MEMORY_ERROR.
+//!
+int getstat_append(getstat *** pstats, const char *instanceId, long long timestamp, const char *metricName, int counterType, const char *dimensionName, double value)
+{
+    getstat *gs = NULL;
+    getstat *gsp = NULL;
+    getstat **gss = NULL;
+    int ninst = 0;
+
+    if ((pstats == NULL) || (instanceId == NULL) || (metricName == NULL) || (dimensionName == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if ((gs = EUCA_ZALLOC(1, sizeof(getstat))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    euca_strncpy(gs->instanceId, instanceId, sizeof(gs->instanceId));
+    gs->timestamp = timestamp;
+    euca_strncpy(gs->metricName, metricName, sizeof(gs->metricName));
+    gs->counterType = counterType;
+    euca_strncpy(gs->dimensionName, dimensionName, sizeof(gs->dimensionName));
+    gs->value = value;
+
+    if ((gsp = getstat_find(*pstats, instanceId)) == NULL) {    // first record for this instance => expand pointer array
+        ninst = getstat_ninstances(*pstats);
+        if ((gss = EUCA_REALLOC(*pstats, (ninst + 2), sizeof(getstat *))) == NULL) {
+            EUCA_FREE(gs);
+            return (EUCA_MEMORY_ERROR);
+        }
+        gss[ninst] = gs;
+        gss[ninst + 1] = NULL;         // NULL-terminate the array
+        *pstats = gss;
+    } else {                           // not first record
+        for (; gsp->next != NULL; gsp = gsp->next) ;    // walk the linked list to the end
+        gsp->next = gs;                // add the new record
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//! Parses the output of the getstats scripts, one line per measurement with
+//! tab-delimited fields, and appends the values to the stats array.
+//!
+//! @param[in] output the script output (modified by the tokenizer)
+//! @param[in,out] pstats
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int getstat_parse(char *output, getstat *** pstats)
+{
+    char *token, *subtoken;
+    char *saveptr1, *saveptr2;
+    char *str1 = output;
+
+    for (int i = 1;; i++, str1 = NULL) {    // iterate over lines in output
+        token = strtok_r(str1, "\n", &saveptr1);    // token points to a whole line
+        if (token == NULL)
+            break;
+
+        char instanceId[100] = "";
+        char metricName[100] = "";
+        char dimensionName[100] = "";
+        long long timestamp = 0;
+        int counterType = SENSOR_UNUSED;
+        double value = 0;
+        int nfields = 0;
+
+        char *str2 = token;
+        for (int j = 1;; j++, str2 = NULL) {    // iterate over tab-separated entries in the line
+            subtoken = strtok_r(str2, "\t", &saveptr2);
+            if (subtoken == NULL)
+                break;
+            nfields = j;
+            // e.g. line: i-760B43A1      1347407243789   NetworkIn       summation       total   2112765752
+            switch (j) {
+            case 1:                   // first entry is instance ID
+                euca_strncpy(instanceId, subtoken, sizeof(instanceId));
+                break;
+            case 2:{
+                    char *endptr;
+                    errno = 0;
+                    timestamp = strtoll(subtoken, &endptr, 10);
+                    if (errno != 0 && *endptr != '\0') {
+                        LOGERROR("unexpected input from getstats.pl (could not convert timestamp with strtoll())\n");
+                        return (EUCA_ERROR);
+                    }
+                    break;
+                }
+            case 3:
+                euca_strncpy(metricName, subtoken, sizeof(metricName));
+                break;
+            case 4:
+                counterType = sensor_str2type(subtoken);
+                break;
+            case 5:
+                euca_strncpy(dimensionName, subtoken, sizeof(dimensionName));
+                break;
+            case 6:{
+                    char *endptr;
+                    errno = 0;
+                    value = strtod(subtoken, &endptr);
+                    if (errno != 0 && *endptr != '\0') {
+                        LOGERROR("unexpected input from getstats.pl (could not convert value with strtod())\n");
+                        return (EUCA_ERROR);
+                    }
+                    break;
+                }
+            default:
+                LOGERROR("unexpected input from getstats.pl (too many fields)\n");
+                return (EUCA_ERROR);
+            }
+        }
+
+        if (nfields == 0)              // empty line
+            continue;
+
+        if (getstat_append(pstats, instanceId, timestamp, metricName, counterType, dimensionName, value) != EUCA_OK)
+            return (EUCA_ERROR);
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//! Obtains stats from the native collector (registered by the NC with
+//! sensor_set_stats_collector()) or, without one, from the getstats scripts.
+//! The externally-routed network counters always come from getstats_net.pl
+//! since they are kept in iptables chains.
 //!
 //! @param[in,out] pstats
 //!
@@ -318,115 +648,57 @@ static int getstat_generate(getstat *** pstats)
 {
     assert(sensor_state != NULL && state_sem != NULL);
 
-    errno = 0;
+    int ret = EUCA_ERROR;
+    boolean collected = FALSE;
+    char *instroot = NULL;
     char *output = NULL;
-    if (!strcmp(euca_this_component_name, "cc")) {
-        char *instroot = NULL;
-        char getstats_cmd[EUCA_MAX_PATH] = "";
+    char getstats_net_cmd[EUCA_MAX_PATH] = "";
 
-        if (euca_sanitize_path(getenv(EUCALYPTUS_ENV_VAR_NAME)) == EUCA_OK) {
-            instroot = strdup(getenv(EUCALYPTUS_ENV_VAR_NAME));
-            snprintf(getstats_cmd, EUCA_MAX_PATH, EUCALYPTUS_LIBEXEC_DIR "/euca_rootwrap " EUCALYPTUS_DATA_DIR "/getstats_net.pl", instroot, instroot);
-            EUCA_FREE(instroot);
-        } else {
-            snprintf(getstats_cmd, EUCA_MAX_PATH, EUCALYPTUS_LIBEXEC_DIR "/euca_rootwrap " EUCALYPTUS_DATA_DIR "/getstats_net.pl", "", "");
-        }
+    if (euca_sanitize_path(getenv(EUCALYPTUS_ENV_VAR_NAME)) == EUCA_OK) {
+        instroot = strdup(getenv(EUCALYPTUS_ENV_VAR_NAME));
+        snprintf(getstats_net_cmd, EUCA_MAX_PATH, EUCALYPTUS_LIBEXEC_DIR "/euca_rootwrap " EUCALYPTUS_DATA_DIR "/getstats_net.pl", instroot, instroot);
+        EUCA_FREE(instroot);
+    } else {
+        snprintf(getstats_net_cmd, EUCA_MAX_PATH, EUCALYPTUS_LIBEXEC_DIR "/euca_rootwrap " EUCALYPTUS_DATA_DIR "/getstats_net.pl", "", "");
+    }
 
-        output = system_output(getstats_cmd);   // invoke th Perl script
+    errno = 0;
+    if (!strcmp(euca_this_component_name, "cc")) {
+        output = system_output(getstats_net_cmd);   // invoke th Perl script
         LOGTRACE("getstats_net.pl output:\n%s\n", output);
     } else if (!strcmp(euca_this_component_name, "nc")) {
         // Right now !CC means the NC.
-        output = system_output("euca_rootwrap getstats.pl");    // invoke th Perl script
-        LOGTRACE("getstats.pl output:\n%s\n", output);
+        if (stats_collector != NULL) {
+            if (stats_collector(pstats) == EUCA_OK) {
+                LOGTRACE("native collector polled statistics for %d instance(s)\n", getstat_ninstances(*pstats));
+                collected = TRUE;
+            } else {
+                LOGWARN("native stats collector failed, falling back to getstats.pl\n");
+                getstat_free(*pstats);
+                *pstats = NULL;
+            }
+        }
+
+        if (collected) {
+            output = system_output(getstats_net_cmd);   // getstats.pl would have invoked it for us
+            LOGTRACE("getstats_net.pl output:\n%s\n", output);
+        } else {
+            output = system_output("euca_rootwrap getstats.pl");    // invoke th Perl script
+            LOGTRACE("getstats.pl output:\n%s\n", output);
+        }
     } else {
         // output will be NULL, so we'll return with an error
         errno = EBADSLT;               // using an obscure errno to mean internal error
     }
 
-    int ret = EUCA_ERROR;
     if (output) {                      // output is a string with one line per measurement, with tab-delimited fields
-        char *token, *subtoken;
-        char *saveptr1, *saveptr2;
-        char *str1 = output;
-        getstat **gss = NULL;
-        int ninst = 0;
-
-        for (int i = 1;; i++, str1 = NULL) {    // iterate over lines in output
-            token = strtok_r(str1, "\n", &saveptr1);    // token points to a whole line
-            if (token == NULL)
-                break;
-            getstat *gs = EUCA_ZALLOC(1, sizeof(getstat));  // new lines means new data record
-            if (gs == NULL)
-                goto bail;
-
-            char *str2 = token;
-            for (int j = 1;; j++, str2 = NULL) {    // iterate over tab-separated entries in the line
-                subtoken = strtok_r(str2, "\t", &saveptr2);
-                if (subtoken == NULL) {
-                    if (j == 1)
-                        EUCA_FREE(gs);
-                    break;
-                }
-                // e.g. line: i-760B43A1      1347407243789   NetworkIn       summation       total   2112765752
-                switch (j) {
-                case 1:{              // first entry is instance ID
-                        getstat *gsp = getstat_find(*pstats, subtoken);
-                        if (gsp == NULL) {  // first record for this instance => expand pointer array
-                            ninst++;
-                            gss = EUCA_REALLOC(gss, (ninst + 1), sizeof(getstat *));
-                            gss[ninst - 1] = gs;
-                            gss[ninst] = NULL;  // NULL-terminate the array
-                            *pstats = gss;
-                        } else {       // not first record
-                            for (; gsp->next != NULL; gsp = gsp->next) ;    // walk the linked list to the end
-                            gsp->next = gs; // add the new record
-                        }
-                        euca_strncpy(gs->instanceId, subtoken, sizeof(gs->instanceId));
-                        break;
-                    }
-                case 2:{
-                        char *endptr;
-                        errno = 0;
-                        gs->timestamp = strtoll(subtoken, &endptr, 10);
-                        if (errno != 0 && *endptr != '\0') {
-                            LOGERROR("unexpected input from getstats.pl (could not convert timestamp with strtoll())\n");
-                            goto bail;
-                        }
-                        break;
-                    }
-                case 3:
-                    euca_strncpy(gs->metricName, subtoken, sizeof(gs->metricName));
-                    break;
-                case 4:
-                    gs->counterType = sensor_str2type(subtoken);
-                    break;
-                case 5:
-                    euca_strncpy(gs->dimensionName, subtoken, sizeof(gs->dimensionName));
-                    break;
-                case 6:{
-                        char *endptr;
-                        errno = 0;
-                        gs->value = strtod(subtoken, &endptr);
-                        if (errno != 0 && *endptr != '\0') {
-                            LOGERROR("unexpected input from getstats.pl (could not convert value with strtod())\n");
-                            goto bail;
-                        }
-                        break;
-                    }
-                default:
-                    LOGERROR("unexpected input from getstats.pl (too many fields)\n");
-                    goto bail;
-                }
-            }
+        if ((ret = getstat_parse(output, pstats)) != EUCA_OK) {
+            getstat_free(*pstats);
+            *pstats = NULL;
         }
-        ret = EUCA_OK;
-        goto done;
-
-bail:
-        getstat_free(*pstats);
-
-done:
         EUCA_FREE(output);
+    } else if (collected) {
+        ret = EUCA_OK;                 // the instance counters are in, only the external network ones are missing
     } else {
         LOGWARN("failed to invoke getstats for sensor data (%s)\n", strerror(errno));
     }
@@ -469,7 +741,7 @@ static void sensor_bottom_half(void)
         }
         sem_v(state_sem);
 
-        useconds_t start_usec = time_usec();
+        long long start_usec = mono_time_usec();
 
         //Run internal stats sensor updates
         /*
@@ -507,7 +779,7 @@ static void sensor_bottom_half(void)
         if (hyp_sem)
             sem_v(hyp_sem);
 
-        useconds_t stop_usec = time_usec();
+        long long stop_usec = mono_time_usec();
 
         // adjust the next sleep time to account for how long sensor refresh took
         next_sleep_duration_usec = next_sleep_duration_usec - (stop_usec - start_usec);
@@ -537,12 +809,18 @@ static void *sensor_thread(void *arg)
 //!
 static void init_state(int resources_size)
 {
-    LOGDEBUG("initializing sensor shared memory (%lu KB)...\n", (sizeof(sensorResourceCache) + sizeof(sensorResource) * (resources_size - 1)) / 1024);
+    LOGDEBUG("initializing sensor shared memory (%lu KB)...\n", SENSOR_CACHE_SIZE(resources_size) / 1024);
+    if (resources_size > (SENSOR_INDEX_SIZE / 2)) {
+        LOGWARN("sensor cache of %d resources exceeds the lookup index, using %d\n", resources_size, (SENSOR_INDEX_SIZE / 2));
+        resources_size = (SENSOR_INDEX_SIZE / 2);
+    }
     sensor_state->max_resources = resources_size;
     sensor_state->collection_interval_time_ms = 0;
     sensor_state->history_size = 0;
     sensor_state->last_polled = 0;
     sensor_state->interval_polled = 0;
+    sensor_state->index_seq = 0;
+    bzero(sensor_state->index, sizeof(sensor_state->index));
     for (int i = 0; i < resources_size; i++) {
         sensorResource *sr = sensor_state->resources + i;
         bzero(sr, sizeof(sensorResource));
@@ -563,6 +841,225 @@ static __inline__ boolean is_empty_sr(const sensorResource * sr)
     return (sr == NULL || sr->resourceName[0] == '\0');
 }
 
+//!
+//! Opens a write section on a sequence counter. Readers that see an odd
+//! value, or a value that changed while they were reading, retry.
+//!
+//! @param[in] seq pointer to the sequence counter
+//!
+//! @note must be called with state_sem held
+//!
+static __inline__ void sensor_write_begin(volatile unsigned int *seq)
+{
+    (*seq)++;
+    __sync_synchronize();
+}
+
+//!
+//! Closes a write section opened with sensor_write_begin()
+//!
+//! @param[in] seq pointer to the sequence counter
+//!
+static __inline__ void sensor_write_end(volatile unsigned int *seq)
+{
+    __sync_synchronize();
+    (*seq)++;
+}
+
+//!
+//! Returns the key of a resource in the given lookup index
+//!
+//! @param[in] idx the lookup index (SENSORIDX_NAME or SENSORIDX_ALIAS)
+//! @param[in] sr pointer to the sensor resource
+//!
+//! @return the key or NULL if the resource has none for this index
+//!
+static const char *sensor_index_key(int idx, const sensorResource * sr)
+{
+    const char *key = (idx == SENSORIDX_NAME) ? sr->resourceName : sr->resourceAlias;
+
+    if (key[0] == '\0')
+        return (NULL);
+    return (key);
+}
+
+//!
+//! Computes the home bucket of a key in a resource lookup index
+//!
+//! @param[in] key the key to hash
+//!
+//! @return the bucket number
+//!
+static int sensor_index_bucket(const char *key)
+{
+    unsigned int h = 2166136261U;      // FNV-1a, kept local so every binary linking sensor.o does not have to pull in hash.o
+
+    for (int i = 0; (i < MAX_SENSOR_NAME_LEN) && (key[i] != '\0'); i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619U;
+    }
+    return ((int)(h & (SENSOR_INDEX_SIZE - 1)));
+}
+
+//!
+//! Adds a resource slot to the given lookup index (open addressing, linear probing)
+//!
+//! @param[in] idx the lookup index
+//! @param[in] slot the sensor resource slot
+//!
+//! @note must be called with state_sem held, after the key has been set
+//!
+static void sensor_index_insert(int idx, int slot)
+{
+    int i = 0;
+    int *table = sensor_state->index[idx];
+    const char *key = NULL;
+
+    if ((key = sensor_index_key(idx, sensor_state->resources + slot)) == NULL)
+        return;
+
+    sensor_write_begin(&(sensor_state->index_seq));
+    for (i = sensor_index_bucket(key); table[i] != 0; i = ((i + 1) & (SENSOR_INDEX_SIZE - 1))) {
+        if (table[i] == (slot + 1))
+            break;
+    }
+    table[i] = (slot + 1);
+    sensor_write_end(&(sensor_state->index_seq));
+}
+
+//!
+//! Removes a resource slot from the given lookup index. The following entries of
+//! the probe run are shifted back so lookups never need tombstones.
+//!
+//! @param[in] idx the lookup index
+//! @param[in] slot the sensor resource slot
+//!
+//! @note must be called with state_sem held, before the key changes
+//!
+static void sensor_index_remove(int idx, int slot)
+{
+    int i = 0;
+    int j = 0;
+    int home = 0;
+    int *table = sensor_state->index[idx];
+    const char *key = NULL;
+
+    if ((key = sensor_index_key(idx, sensor_state->resources + slot)) == NULL)
+        return;
+
+    for (i = sensor_index_bucket(key); table[i] != (slot + 1); i = ((i + 1) & (SENSOR_INDEX_SIZE - 1))) {
+        if (table[i] == 0)
+            return;
+    }
+
+    sensor_write_begin(&(sensor_state->index_seq));
+    table[i] = 0;
+    for (j = ((i + 1) & (SENSOR_INDEX_SIZE - 1)); table[j] != 0; j = ((j + 1) & (SENSOR_INDEX_SIZE - 1))) {
+        key = sensor_index_key(idx, sensor_state->resources + (table[j] - 1));
+        home = (key) ? sensor_index_bucket(key) : j;
+        // leave the entry where it is if its home bucket lies cyclically in (i, j]
+        if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j)))
+            continue;
+        table[i] = table[j];
+        table[j] = 0;
+        i = j;
+    }
+    sensor_write_end(&(sensor_state->index_seq));
+}
+
+//!
+//! Looks up a resource slot by key in the given lookup index. Safe to call
+//! without state_sem, in which case the caller must validate the result
+//! against index_seq and the resource's own sequence counter.
+//!
+//! @param[in] idx the lookup index
+//! @param[in] key the resource name or alias to look for
+//!
+//! @return the sensor resource slot or -1 if not found
+//!
+static int sensor_index_find(int idx, const char *key)
+{
+    int i = 0;
+    int n = 0;
+    int slot = 0;
+    int *table = sensor_state->index[idx];
+    const sensorResource *sr = NULL;
+    const char *slotkey = NULL;
+
+    if (!key || (key[0] == '\0'))
+        return (-1);
+
+    for (i = sensor_index_bucket(key); (table[i] != 0) && (n < SENSOR_INDEX_SIZE); i = ((i + 1) & (SENSOR_INDEX_SIZE - 1)), n++) {
+        slot = table[i] - 1;
+        if ((slot < 0) || (slot >= sensor_state->max_resources))
+            continue;
+        sr = sensor_state->resources + slot;
+        if (!is_empty_sr(sr) && ((slotkey = sensor_index_key(idx, sr)) != NULL) && !strncmp(slotkey, key, MAX_SENSOR_NAME_LEN))
+            return (slot);
+    }
+    return (-1);
+}
+
+//!
+//! Finds a resource slot by name or alias without taking state_sem
+//!
+//! @param[in]  name the resource name or alias to look for
+//! @param[in]  by_alias set to also match resource aliases
+//! @param[out] slot the sensor resource slot, or -1 if the resource is not in the cache
+//!
+//! @return TRUE if the answer is consistent, FALSE if the indexes kept changing under us
+//!
+static boolean sensor_lookup_nolock(const char *name, boolean by_alias, int *slot)
+{
+    unsigned int seq = 0;
+
+    for (int i = 0; i < SENSOR_READ_RETRIES; i++) {
+        seq = sensor_state->index_seq;
+        __sync_synchronize();
+        if (!(seq & 1)) {
+            *slot = sensor_index_find(SENSORIDX_NAME, name);
+            if ((*slot < 0) && by_alias)
+                *slot = sensor_index_find(SENSORIDX_ALIAS, name);
+            __sync_synchronize();
+            if (sensor_state->index_seq == seq)
+                return (TRUE);
+        }
+        sched_yield();
+    }
+    return (FALSE);
+}
+
+//!
+//! Takes a consistent copy of a resource out of the shared cache. The
+//! writer is never blocked: the copy is retried if the resource changed
+//! while it was being read, and state_sem is only taken after
+//! SENSOR_READ_RETRIES failed attempts.
+//!
+//! @param[in]  sr pointer to the resource in the shared cache
+//! @param[out] out pointer to the copy to fill
+//!
+static void sensor_copy_sr(const sensorResource * sr, sensorResource * out)
+{
+    unsigned int seq = 0;
+
+    for (int i = 0; i < SENSOR_READ_RETRIES; i++) {
+        seq = sr->seq;
+        __sync_synchronize();
+        if (!(seq & 1)) {
+            memcpy(out, (const void *)sr, sizeof(sensorResource));
+            __sync_synchronize();
+            if (sr->seq == seq)
+                return;
+        }
+        sched_yield();
+    }
+
+    // too much write contention, pay for the lock
+    sem_p(state_sem);
+    memcpy(out, (const void *)sr, sizeof(sensorResource));
+    sem_v(state_sem);
+}
+
 //!
 //! This must be called from within a state_sem lock--it doesn't do its
 //! own locking.
@@ -596,7 +1093,11 @@ static int sensor_expire_cache_entries(void)
 
         if (cache_timeout && (timestamp_age > cache_timeout)) {
             LOGINFO("expiring resource %s from sensor cache, no update in %ld seconds, timeout is %ld seconds\n", sr->resourceName, timestamp_age, cache_timeout);
+            sensor_index_remove(SENSORIDX_NAME, r);
+            sensor_index_remove(SENSORIDX_ALIAS, r);
+            sensor_write_begin(&(sr->seq));
             sr->resourceName[0] = '\0'; // marks the slot as empty
+            sensor_write_end(&(sr->seq));
             ret++;
         }
     }
@@ -668,7 +1169,7 @@ int sensor_init(sem * sem, sensorResourceCache * resources, int resources_size,
             return (EUCA_MEMORY_ERROR);
         }
 
-        sensor_state = EUCA_ZALLOC(sizeof(sensorResourceCache) + sizeof(sensorResource), (use_resources_size - 1));
+        sensor_state = EUCA_ZALLOC(1, SENSOR_CACHE_SIZE(use_resources_size));
         if (sensor_state == NULL) {
             LOGFATAL("failed to allocate memory for sensor data\n");
             SEM_FREE(state_sem);
@@ -785,6 +1286,26 @@ int sensor_set_hyp_sem(sem * sem)
     return (EUCA_OK);
 }
 
+//!
+//! Registers a native collector that the polling loop uses in place of
+//! the getstats.pl script. Passing NULL restores the script.
+//!
+//! @param[in] collector
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int sensor_set_stats_collector(sensorStatsCollector collector)
+{
+    if (sensor_state == NULL || sensor_state->initialized == FALSE)
+        return (EUCA_ERROR);
+
+    sem_p(state_sem);
+    stats_collector = collector;
+    sem_v(state_sem);
+
+    return (EUCA_OK);
+}
+
 //!
 //!
 //!
@@ -1036,42 +1557,41 @@ static sensorResource *find_or_alloc_sr(const boolean do_alloc, const char *reso
         return NULL;
     }
 
-    sensorResource *unused_sr = NULL;
-    for (int r = 0; r < sensor_state->max_resources; r++) {
-        sensorResource *sr = sensor_state->resources + r;
-
-        if (is_empty_sr(sr)) {         // unused slot
-            // remember the first unused slot in case we do not find this resource
-            if (unused_sr == NULL) {
-                unused_sr = sr;
-            }
-            continue;
-        }
-        // we have a match
-        if ((strcmp(sr->resourceName, resourceName) == 0) || (strcmp(sr->resourceAlias, resourceName) == 0)) {
-            if (resourceType) {
-                if (strcmp(sr->resourceType, resourceType) == 0) {
-                    return sr;
-                }
-            }
-            return sr;
-        }
-    }
+    // we have a match, by name or by alias
+    int slot = sensor_index_find(SENSORIDX_NAME, resourceName);
+    if (slot < 0)
+        slot = sensor_index_find(SENSORIDX_ALIAS, resourceName);
+    if (slot >= 0)
+        return (sensor_state->resources + slot);
 
     if (!do_alloc)
         return NULL;
     if (resourceType == NULL)          // must be set for allocation
         return NULL;
 
+    // only allocation has to look for the first unused slot
+    sensorResource *unused_sr = NULL;
+    for (int r = 0; r < sensor_state->max_resources; r++) {
+        if (is_empty_sr(sensor_state->resources + r)) {
+            unused_sr = sensor_state->resources + r;
+            break;
+        }
+    }
+
     // fill out the new slot
     if (unused_sr != NULL) {
+        sensor_write_begin(&(unused_sr->seq));
+        unsigned int seq = unused_sr->seq;
         bzero(unused_sr, sizeof(sensorResource));
+        unused_sr->seq = seq;
         euca_strncpy(unused_sr->resourceName, resourceName, sizeof(unused_sr->resourceName));
         if (resourceType)
             euca_strncpy(unused_sr->resourceType, resourceType, sizeof(unused_sr->resourceType));
         if (resourceUuid)
             euca_strncpy(unused_sr->resourceUuid, resourceUuid, sizeof(unused_sr->resourceUuid));
         unused_sr->timestamp = time(NULL);
+        sensor_write_end(&(unused_sr->seq));
+        sensor_index_insert(SENSORIDX_NAME, unused_sr - sensor_state->resources);
         sensor_state->used_resources++;
         LOGINFO("allocated new sensor resource %s\n", resourceName);
     }
@@ -1194,6 +1714,84 @@ static sensorDimension *find_or_alloc_sd(const boolean do_alloc, sensorCounter *
     return sd;
 }
 
+//!
+//! Finds the rollups of a dimension of a resource in the cache. The rollup series of a
+//! resource follow the resources in the cache, and a dimension takes the next one free
+//! when it first gets values, so they go away with the resource.
+//!
+//! @param[in] sr pointer to the resource in the cache
+//! @param[in] sd pointer to the dimension of the resource
+//! @param[in] do_alloc set to TRUE to give the dimension rollups if it has none
+//!
+//! @return a pointer to the rollups or NULL if the dimension has none
+//!
+//! @note this must be called with state_sem held
+//!
+static sensorRollupSeries *sensor_rollup_series(sensorResource * sr, sensorDimension * sd, const boolean do_alloc)
+{
+    sensorRollupSeries *series = ((sensorRollupSeries *) (sensor_state->resources + sensor_state->max_resources)) + ((sr - sensor_state->resources) * SENSOR_ROLLUP_SERIES);
+
+    if ((sd->rollupSeries < 0) || (sd->rollupSeries > sr->rollupSeriesLen) || (sr->rollupSeriesLen > SENSOR_ROLLUP_SERIES)) {   // sanity check
+        LOGWARN("inconsistency in sensor database (rollupSeries=%d of %d for %s:%s)\n", sd->rollupSeries, sr->rollupSeriesLen, sr->resourceName, sd->dimensionName);
+        return NULL;
+    }
+
+    if (sd->rollupSeries == 0) {
+        if (!do_alloc || (sr->rollupSeriesLen == SENSOR_ROLLUP_SERIES))  // out of room
+            return NULL;
+        sd->rollupSeries = ++sr->rollupSeriesLen;
+        bzero(series + (sd->rollupSeries - 1), sizeof(sensorRollupSeries));
+    }
+    return (series + (sd->rollupSeries - 1));
+}
+
+//!
+//! Adds a value to the rollups of its dimension, in the current period of every tier. A
+//! period that is over makes room for a new one, taking the place of the oldest one when
+//! the ring is full. Values received again are not counted twice.
+//!
+//! @param[in] series pointer to the rollups of the dimension
+//! @param[in] sv pointer to the value
+//!
+//! @note this must be called with state_sem held
+//!
+static void sensor_rollup_add(sensorRollupSeries * series, const sensorValue * sv)
+{
+    int t = 0;
+    int len = 0;
+    long long startMs = 0;
+    sensorRollup *ru = NULL;
+
+    if (sv->timestampMs <= series->lastMs)
+        return;
+    series->lastMs = sv->timestampMs;
+    if (!sv->available)
+        return;
+
+    for (t = 0; t < SENSOR_ROLLUP_TIERS; t++) {
+        startMs = sv->timestampMs - (sv->timestampMs % sensor_rollup_period_ms[t]);
+        len = series->rollupsLen[t];
+        ru = ((len > 0) ? (series->rollups[t] + ((series->firstRollupIndex[t] + len - 1) % SENSOR_ROLLUP_PERIODS)) : NULL);
+        if ((ru == NULL) || (ru->startMs != startMs)) {
+            if (len == SENSOR_ROLLUP_PERIODS) {
+                series->firstRollupIndex[t] = ((series->firstRollupIndex[t] + 1) % SENSOR_ROLLUP_PERIODS);
+                len--;
+            }
+            ru = series->rollups[t] + ((series->firstRollupIndex[t] + len) % SENSOR_ROLLUP_PERIODS);
+            bzero(ru, sizeof(sensorRollup));
+            ru->startMs = startMs;
+            series->rollupsLen[t] = len + 1;
+        }
+
+        if ((ru->count == 0) || (sv->value < ru->min))
+            ru->min = sv->value;
+        if ((ru->count == 0) || (sv->value > ru->max))
+            ru->max = sv->value;
+        ru->sum += sv->value;
+        ru->count++;
+    }
+}
+
 //!
 //! Merges records in srs[] array of pointers (of length srsLen)
 //! into records in the in-memory sensor values cache.  The merge
@@ -1218,6 +1816,7 @@ int sensor_merge_records(sensorResource * srs[], int srsLen, boolean fail_on_oom
 
     int ret = EUCA_ERROR;
     int num_merged = 0;
+    sensorResource *writing_sr = NULL; // resource whose write section is open, closed on the way out
     sem_p(state_sem);
     for (int r = 0; r < srsLen; r++) {
         const sensorResource *sr = srs[r];
@@ -1231,6 +1830,9 @@ int sensor_merge_records(sensorResource * srs[], int srsLen, boolean fail_on_oom
                 goto bail;
             continue;
         }
+        // lock-free readers retry while this resource is being written
+        sensor_write_begin(&(cache_sr->seq));
+        writing_sr = cache_sr;
 
         for (int m = 0; m < sr->metricsLen; m++) {
             const sensorMetric *sm = sr->metrics + m;
@@ -1322,17 +1924,20 @@ int sensor_merge_records(sensorResource * srs[], int srsLen, boolean fail_on_oom
                         iov--;
                     }
 
-                    // step 2: if there is new data, copy it into the right place
+                    // step 2: if there is new data, copy it into the right place, adding it to the rollups
 
                     if (inv_start >= 0) {   // there is new data to copy
                         int iov = iov_start;
                         int copied = 0;
+                        sensorRollupSeries *series = sensor_rollup_series(cache_sr, cache_sd, TRUE);
                         for (int inv = inv_start; inv < sd->valuesLen; inv++, iov++) {
                             int vn_adj = (inv + sd->firstValueIndex) % MAX_SENSOR_VALUES;   // values adjusted for firstValueIndex
                             int vo_adj = (iov + cache_sd->firstValueIndex) % MAX_SENSOR_VALUES;
                             cache_sd->values[vo_adj].timestampMs = sd->values[vn_adj].timestampMs;
                             cache_sd->values[vo_adj].available = sd->values[vn_adj].available;
                             cache_sd->values[vo_adj].value = sd->values[vn_adj].value;
+                            if (series)
+                                sensor_rollup_add(series, cache_sd->values + vo_adj);
 
                             // if this is the first value for a SUMMATION-type counter (seq num is zero),
                             // set the shift to the negative of the value so that values go back to zero, too
@@ -1371,12 +1976,16 @@ int sensor_merge_records(sensorResource * srs[], int srsLen, boolean fail_on_oom
             }
         }
         cache_sr->timestamp = time(NULL);
+        sensor_write_end(&(cache_sr->seq));
+        writing_sr = NULL;
         LOGTRACE("updated %s cache timestamp to %d\n", cache_sr->resourceName, cache_sr->timestamp);
     }
     ret = EUCA_OK;
 
 bail:
 
+    if (writing_sr)
+        sensor_write_end(&(writing_sr->seq));
     sem_v(state_sem);
     LOGTRACE("completed: merged %d values, ret=%d\n", num_merged, ret);
 
@@ -1471,43 +2080,86 @@ int sensor_get_value(const char *instanceId, const char *metricName, const int c
                      boolean * available, double *value, long long *intervalMs, int *valLen)
 {
     int ret = EUCA_ERROR;
+    int slot = -1;
+    unsigned int seq = 0;
     if (sensor_state == NULL || sensor_state->initialized == FALSE)
         return (EUCA_ERROR);
 
+    // read in place without blocking the writer, retrying if the resource changed under us
+    for (int i = 0; i < SENSOR_READ_RETRIES; i++) {
+        if (!sensor_lookup_nolock(instanceId, TRUE, &slot))
+            break;
+        if (slot < 0)
+            return (EUCA_ERROR);
+
+        const sensorResource *sr = sensor_state->resources + slot;
+        seq = sr->seq;
+        __sync_synchronize();
+        if (!(seq & 1)) {
+            ret = sensor_read_latest(sr, metricName, counterType, dimensionName, sequenceNum, timestampMs, available, value, intervalMs, valLen);
+            __sync_synchronize();
+            if (sr->seq == seq)
+                return (ret);
+        }
+        sched_yield();
+    }
+
+    // too much write contention, pay for the lock
     sem_p(state_sem);
+    ret = EUCA_ERROR;
     sensorResource *cache_sr = find_or_alloc_sr(FALSE, instanceId, "instance", NULL);
-    if (cache_sr == NULL)
-        goto bail;
+    if (cache_sr != NULL)
+        ret = sensor_read_latest(cache_sr, metricName, counterType, dimensionName, sequenceNum, timestampMs, available, value, intervalMs, valLen);
+    sem_v(state_sem);
+    return ret;
+}
 
-    sensorMetric *cache_sm = find_or_alloc_sm(FALSE, cache_sr, metricName);
+//!
+//! Reads the latest value of a (metric x counter x dimension) of a resource
+//!
+//! @param[in]  sr pointer to the sensor resource
+//! @param[in]  metricName
+//! @param[in]  counterType
+//! @param[in]  dimensionName
+//! @param[out] sequenceNum
+//! @param[out] timestampMs
+//! @param[out] available
+//! @param[out] value
+//! @param[out] intervalMs
+//! @param[out] valLen
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if there is no such value
+//!
+//! @note the caller either holds state_sem or validates the resource's sequence counter
+//!
+static int sensor_read_latest(const sensorResource * sr, const char *metricName, const int counterType, const char *dimensionName, long long *sequenceNum,
+                              long long *timestampMs, boolean * available, double *value, long long *intervalMs, int *valLen)
+{
+    sensorMetric *cache_sm = find_or_alloc_sm(FALSE, (sensorResource *) sr, metricName);
     if (cache_sm == NULL)
-        goto bail;
+        return (EUCA_ERROR);
 
     sensorCounter *cache_sc = find_or_alloc_sc(FALSE, cache_sm, counterType);
     if (cache_sc == NULL)
-        goto bail;
+        return (EUCA_ERROR);
 
     sensorDimension *cache_sd = find_or_alloc_sd(FALSE, cache_sc, dimensionName);
     if (cache_sd == NULL)
-        goto bail;
+        return (EUCA_ERROR);
 
-    if (cache_sd->valuesLen < 1)       // no values in this dimension at all
-        goto bail;
+    int len = cache_sd->valuesLen;
+    if (len < 1 || len > MAX_SENSOR_VALUES) // no values in this dimension at all
+        return (EUCA_ERROR);
 
-    *sequenceNum = cache_sd->sequenceNum + cache_sd->valuesLen - 1;
+    *sequenceNum = cache_sd->sequenceNum + len - 1;
     *intervalMs = cache_sc->collectionIntervalMs;
-    *valLen = cache_sd->valuesLen;
+    *valLen = len;
 
-    sensorValue *sv = cache_sd->values + ((cache_sd->firstValueIndex + cache_sd->valuesLen - 1) % MAX_SENSOR_VALUES);
+    const sensorValue *sv = cache_sd->values + ((cache_sd->firstValueIndex + len - 1) % MAX_SENSOR_VALUES);
     *timestampMs = sv->timestampMs;
     *available = sv->available;
     *value = sv->value;
-    ret = EUCA_OK;
-
-bail:
-
-    sem_v(state_sem);
-    return ret;
+    return (EUCA_OK);
 }
 
 //!
@@ -1529,36 +2181,47 @@ int sensor_get_instance_data(const char *instanceId, char **sensorIds, int senso
 
     LOGTRACE("sensor_get_instance_data() called for instance %s\n", instanceId == NULL ? "NULL" : instanceId);
 
-    sem_p(state_sem);
+    // copy the data out without holding state_sem, so the sensor bottom half never waits on a reader
     time_t this_interval = 0;          // For determining polling interval.
     int sri = 0;                       // index into output array sr_out[]
-    for (int r = 0; r < sensor_state->max_resources; r++) {
+    int first = 0;
+    int last = sensor_state->max_resources;
+    if (instanceId != NULL) {          // we are looking for a specific instance (rather than all)
+        int slot = -1;
+        if (!sensor_lookup_nolock(instanceId, FALSE, &slot)) {
+            sem_p(state_sem);
+            slot = sensor_index_find(SENSORIDX_NAME, instanceId);
+            sem_v(state_sem);
+        }
+        first = slot;
+        last = slot + 1;
+    }
+    for (int r = first; r >= 0 && r < last; r++) {
         sensorResource *sr = sensor_state->resources + r;
 
         if (is_empty_sr(sr))           // unused slot in cache, skip it
             continue;
 
-        if ((instanceId != NULL)       // we are looking for a specific instance (rather than all)
-            && (strcmp(sr->resourceName, instanceId) != 0)) // and this is not the one
-            continue;
-
         if (sensorIdsLen > 0)          //! @todo implement support for sensorIds[]
             goto bail;
 
         if (sri >= srLen)              // out of room in output
             goto bail;                 //! @fixme Log something here?
 
-        memcpy(sr_out[sri], sr, sizeof(sensorResource));    //! @todo run through the data, do not just copy
+        sensor_copy_sr(sr, sr_out[sri]);    //! @todo run through the data, do not just copy
+        if (is_empty_sr(sr_out[sri]))  // expired while we were looking
+            continue;
+        if ((instanceId != NULL) && (strcmp(sr_out[sri]->resourceName, instanceId) != 0))  // slot was reused for another resource
+            continue;
         sri++;
-
-        if (instanceId != NULL)        // only one instance to copy
-            break;
     }
     if (sri > 0)                       // we have at least one result
         ret = EUCA_OK;
 
 bail:
 
+    // the polling interval bookkeeping and cache expiration still need the lock, but only briefly
+    sem_p(state_sem);
     if (sensor_state->last_polled) {   // Ensure this isn't the first one.
         time_t t = time(NULL);
         this_interval = t - sensor_state->last_polled;
@@ -1603,6 +2266,57 @@ bail:
     return ret;
 }
 
+//!
+//! Copies out the rollups of a (metric x counter x dimension) of a resource, the oldest
+//! period first. The rollups go further back than the values the cache keeps, and give
+//! the minimum, maximum, sum and number of the values of each period. Values of summation
+//! counters are aggregated as they are kept, without their shift_value.
+//!
+//! @param[in]  resourceName the resource name or alias
+//! @param[in]  metricName
+//! @param[in]  counterType
+//! @param[in]  dimensionName
+//! @param[in]  tier one of SENSOR_ROLLUP_1MIN or SENSOR_ROLLUP_5MIN
+//! @param[out] rollups the array to fill
+//! @param[in]  rollupsSize the number of entries of rollups, only the latest periods are copied if it is too small
+//! @param[out] rollupsLen set to the number of periods copied
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or EUCA_ERROR if there are no such rollups
+//!
+int sensor_get_rollups(const char *resourceName, const char *metricName, const int counterType, const char *dimensionName, const int tier, sensorRollup * rollups,
+                       int rollupsSize, int *rollupsLen)
+{
+    int i = 0;
+    int len = 0;
+    int ret = EUCA_ERROR;
+    sensorResource *sr = NULL;
+    sensorMetric *sm = NULL;
+    sensorCounter *sc = NULL;
+    sensorDimension *sd = NULL;
+    sensorRollupSeries *series = NULL;
+
+    if (sensor_state == NULL || sensor_state->initialized == FALSE)
+        return (EUCA_ERROR);
+
+    if (!resourceName || !metricName || !dimensionName || (tier < 0) || (tier >= SENSOR_ROLLUP_TIERS) || !rollups || (rollupsSize < 1) || !rollupsLen)
+        return (EUCA_INVALID_ERROR);
+
+    *rollupsLen = 0;
+    sem_p(state_sem);
+    if (((sr = find_or_alloc_sr(FALSE, resourceName, NULL, NULL)) != NULL) && ((sm = find_or_alloc_sm(FALSE, sr, metricName)) != NULL)
+        && ((sc = find_or_alloc_sc(FALSE, sm, counterType)) != NULL) && ((sd = find_or_alloc_sd(FALSE, sc, dimensionName)) != NULL)
+        && ((series = sensor_rollup_series(sr, sd, FALSE)) != NULL)) {
+        len = MIN(series->rollupsLen[tier], rollupsSize);
+        for (i = 0; i < len; i++) {
+            rollups[i] = series->rollups[tier][(series->firstRollupIndex[tier] + (series->rollupsLen[tier] - len) + i) % SENSOR_ROLLUP_PERIODS];
+        }
+        *rollupsLen = len;
+        ret = EUCA_OK;
+    }
+    sem_v(state_sem);
+    return (ret);
+}
+
 //!
 //!
 //!
@@ -1644,14 +2358,22 @@ int sensor_set_resource_alias(const char *resourceName, const char *resourceAlia
     sem_p(state_sem);
     sensorResource *sr = find_or_alloc_sr(FALSE, resourceName, NULL, NULL);
     if (sr != NULL) {
+        int slot = sr - sensor_state->resources;
         if (resourceAlias) {
             if (strcmp(sr->resourceAlias, resourceAlias) != 0) {
+                sensor_index_remove(SENSORIDX_ALIAS, slot);
+                sensor_write_begin(&(sr->seq));
                 euca_strncpy(sr->resourceAlias, resourceAlias, sizeof(sr->resourceAlias));
+                sensor_write_end(&(sr->seq));
+                sensor_index_insert(SENSORIDX_ALIAS, slot);
                 LOGDEBUG("set alias for sensor resource %s to %s\n", resourceName, resourceAlias);
             }
         } else {
             LOGTRACE("clearing alias for resource '%s'\n", resourceName);
+            sensor_index_remove(SENSORIDX_ALIAS, slot);
+            sensor_write_begin(&(sr->seq));
             sr->resourceAlias[0] = '\0';    // clears the alias
+            sensor_write_end(&(sr->seq));
         }
         ret = EUCA_OK;
     }
@@ -1676,7 +2398,11 @@ int sensor_remove_resource(const char *resourceName)
     sem_p(state_sem);
     sensorResource *sr = find_or_alloc_sr(FALSE, resourceName, NULL, NULL);
     if (sr != NULL) {
+        sensor_index_remove(SENSORIDX_NAME, sr - sensor_state->resources);
+        sensor_index_remove(SENSORIDX_ALIAS, sr - sensor_state->resources);
+        sensor_write_begin(&(sr->seq));
         sr->resourceName[0] = '\0';    // marks the slot as empty
+        sensor_write_end(&(sr->seq));
         ret = EUCA_OK;
     }
     sem_v(state_sem);
@@ -1703,6 +2429,7 @@ int sensor_shift_metric(const char *resourceName, const char *metricName)
     sensorResource *sr = find_or_alloc_sr(FALSE, resourceName, NULL, NULL);
     if (sr == NULL)
         goto bail;
+    sensor_write_begin(&(sr->seq));
 
     sensorMetric *sm = find_or_alloc_sm(FALSE, sr, metricName);
     if (sm == NULL)
@@ -1766,6 +2493,8 @@ int sensor_shift_metric(const char *resourceName, const char *metricName)
     ret = EUCA_OK;
 
 bail:
+    if (sr != NULL)
+        sensor_write_end(&(sr->seq));
     sem_v(state_sem);
     return (ret);
 }
@@ -1800,6 +2529,7 @@ int sensor_set_dimension_alias(const char *resourceName, const char *metricName,
     sensorResource *sr = find_or_alloc_sr(FALSE, resourceName, NULL, NULL);
     if (sr == NULL)
         goto bail;
+    sensor_write_begin(&(sr->seq));
 
     sensorMetric *sm = find_or_alloc_sm(TRUE, sr, metricName);  // allocate metric if necessary
     if (sm == NULL)
@@ -1833,6 +2563,8 @@ int sensor_set_dimension_alias(const char *resourceName, const char *metricName,
 
 bail:
 
+    if (sr != NULL)
+        sensor_write_end(&(sr->seq));
     sem_v(state_sem);
     return ret;
 }
@@ -1878,32 +2610,48 @@ int sensor_set_volume(const char *instanceId, const char *volumeId, const char *
 //!
 //! @return EUCA_OK on success or EUCA_ERROR on failure
 //!
-int sensor_refresh_resources(char resourceNames[][MAX_SENSOR_NAME_LEN], char resourceAliases[][MAX_SENSOR_NAME_LEN], int size)
+//! Adds the polled values of the resources, found by name or by alias, to the cache. The
+//! values of each resource go into one carrier record and all of them are merged at once,
+//! so the lock is taken once per poll rather than once per value.
+//!
+//! @param[in]  stats the polled values
+//! @param[in]  resourceNames names of the resources, empty for unused entries
+//! @param[in]  resourceAliases aliases of the resources, empty if they have none
+//! @param[in]  size number of entries in resourceNames and resourceAliases
+//! @param[out] nmissing set to the number of resources without any value
+//!
+//! @return the number of values added
+//!
+static int getstat_merge(getstat ** stats, char resourceNames[][MAX_SENSOR_NAME_LEN], char resourceAliases[][MAX_SENSOR_NAME_LEN], int size, int *nmissing)
 {
-    if (sensor_state == NULL || sensor_state->initialized == FALSE)
-        return (EUCA_ERROR);
-
-    LOGTRACE("invoked size=%d\n", size);
-    getstat **stats = NULL;
-    if (getstat_generate(&stats) != EUCA_OK) {
-        LOGWARN("failed to invoke getstats for sensor data\n");
-        return (EUCA_ERROR);
-    } else {
-        LOGDEBUG("polled statistics for %d instance(s)\n", getstat_ninstances(stats));
+    int srsLen = 0;
+    int nvalues = 0;
+    getstat *vals = NULL;
+    getstat *alias_vals = NULL;
+    sensorResource **srs = NULL;
+
+    *nmissing = 0;
+    if ((srs = EUCA_ZALLOC(size, sizeof(sensorResource *))) == NULL) {
+        LOGERROR("out of memory for %d sensor resources\n", size);
+        return (0);
     }
 
-    int nvalues = 0;
     for (int i = 0; i < size; i++) {
         int nvalues_resource = 0;
         char *name = (char *)resourceNames[i];
         char *alias = (char *)resourceAliases[i];
         if (name[0] == '\0')           // empty entry in the array
             continue;
-        getstat *vals = NULL;
-        if ((vals = getstat_find(stats, name)) != NULL)
-            nvalues_resource += getstat_add_values(name, vals);
-        if ((alias[0] != '\0') && (vals = getstat_find(stats, alias))) {
-            nvalues_resource += getstat_add_values(name, vals);
+        vals = getstat_find(stats, name);
+        alias_vals = ((alias[0] != '\0') ? getstat_find(stats, alias) : NULL);
+        if (vals || alias_vals) {
+            if ((srs[srsLen] = EUCA_SLAB_ZALLOC(&sensor_resource_slab)) == NULL) {
+                LOGERROR("out of memory for the values of sensor resource %s\n", name);
+                break;
+            }
+            nvalues_resource += getstat_fill_sr(name, vals, srs[srsLen]);
+            nvalues_resource += getstat_fill_sr(name, alias_vals, srs[srsLen]);
+            srsLen++;
         }
         if (nvalues_resource > 0) {
             nvalues += nvalues_resource;
@@ -1911,6 +2659,39 @@ int sensor_refresh_resources(char resourceNames[][MAX_SENSOR_NAME_LEN], char res
         }
         // can't find this resource by name or by alias
         LOGDEBUG("unable to get metrics for resource %s (OK if it was terminated---should soon expire from the cache)\n", name);
+        (*nmissing)++;
+    }
+
+    // a resource out of room in the cache does not keep the others out
+    if ((srsLen > 0) && (sensor_merge_records(srs, srsLen, FALSE) != EUCA_OK)) {
+        LOGWARN("failed to merge the values of %d sensor resource(s)\n", srsLen);
+    }
+
+    for (int i = 0; i < srsLen; i++) {
+        EUCA_SLAB_FREE(&sensor_resource_slab, srs[i]);
+    }
+    EUCA_FREE(srs);
+    return (nvalues);
+}
+
+//!
+int sensor_refresh_resources(char resourceNames[][MAX_SENSOR_NAME_LEN], char resourceAliases[][MAX_SENSOR_NAME_LEN], int size)
+{
+    if (sensor_state == NULL || sensor_state->initialized == FALSE)
+        return (EUCA_ERROR);
+
+    LOGTRACE("invoked size=%d\n", size);
+    getstat **stats = NULL;
+    if (getstat_generate(&stats) != EUCA_OK) {
+        LOGWARN("failed to invoke getstats for sensor data\n");
+        return (EUCA_ERROR);
+    } else {
+        LOGDEBUG("polled statistics for %d instance(s)\n", getstat_ninstances(stats));
+    }
+
+    int nmissing = 0;
+    int nvalues = getstat_merge(stats, resourceNames, resourceAliases, size, &nmissing);
+    if (nmissing > 0) {
         //! @TODO 3.2: decide what to do when some metrics for an instance aren't available.
         //! One possibility is that the CLC isn't actively polling us, which
         //! means we've not cleaned up the sensor cache recently...and
@@ -1998,137 +2779,1554 @@ next_resource:
     return errors;
 }
 
-#ifdef _UNIT_TEST
 //!
+//! Appends to a growable string
 //!
+//! @param[in,out] text the string to append to
+//! @param[in]     format printf-like format of what to append
+//! @param[in]     ... the format arguments
 //!
-static void dump_sensor_cache(void)
+//! @return EUCA_OK on success or EUCA_ERROR and EUCA_MEMORY_ERROR on failure
+//!
+static int sensor_text_append(sensorText * text, const char *format, ...)
 {
-    sensorResource **srs = EUCA_ZALLOC(sensor_state->max_resources, sizeof(sensorResource *));
-    for (int i = 0; i < sensor_state->max_resources; i++) {
-        srs[i] = &(sensor_state->resources[i]);
+    int len = 0;
+    int size = 0;
+    char *larger = NULL;
+    va_list ap = { {0} };
+
+    for (;;) {
+        if (text->size > text->len) {
+            va_start(ap, format);
+            len = vsnprintf(text->buf + text->len, text->size - text->len, format, ap);
+            va_end(ap);
+            if (len < 0)
+                return (EUCA_ERROR);
+            if ((text->len + len) < text->size) {
+                text->len += len;
+                return (EUCA_OK);
+            }
+        }
+        size = ((text->size > 0) ? (text->size * 2) : SENSOR_TEXT_INITIAL_SIZE);
+        if ((larger = EUCA_REALLOC(text->buf, size, sizeof(char))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        text->buf = larger;
+        text->size = size;
     }
-    log_sensor_resources("whole cache", srs, sensor_state->max_resources);
-    EUCA_FREE(srs);
 }
 
 //!
+//! Looks up a name in the dictionary of a batch or of cursors, adding it if it is not there
+//! yet. The dictionary only keeps a pointer to the name, which must stay valid as long as
+//! the dictionary is used. A failure is remembered in the dictionary, so that callers can
+//! check for it once they are done with the dictionary.
 //!
+//! @param[in,out] dict the dictionary
+//! @param[in]     name the name to look up
 //!
-//! @param[out] srs
-//! @param[in]  srsLen
+//! @return the index of the name or -1 if it cannot be in a dictionary or on out of memory
 //!
-static void clear_srs(sensorResource ** srs, int srsLen)
+static int sensor_dict_index(sensorDict * dict, const char *name)
 {
-    for (int i = 0; i < srsLen; i++) {
-        bzero(srs[i], sizeof(sensorResource));
+    int i = 0;
+    const char **larger = NULL;
+
+    for (i = 0; i < dict->namesLen; i++) {
+        if (!strcmp(dict->names[i], name))
+            return (i);
+    }
+
+    if (strchr(name, '\n') != NULL) {
+        dict->error = EUCA_INVALID_ERROR;
+        return (-1);
+    }
+
+    if (dict->namesLen == dict->namesSize) {
+        if ((larger = EUCA_REALLOC(dict->names, (dict->namesSize + SENSOR_DICT_INCREMENT), sizeof(char *))) == NULL) {
+            dict->error = EUCA_MEMORY_ERROR;
+            return (-1);
+        }
+        dict->names = larger;
+        dict->namesSize += SENSOR_DICT_INCREMENT;
     }
+    if ((dict->error = sensor_text_append(&(dict->text), "%s\n", name)) != EUCA_OK)
+        return (-1);
+    dict->names[dict->namesLen] = name;
+    return (dict->namesLen++);
 }
 
 //!
-//! Main entry point of the application
+//! Cuts the next line out of a batch or of cursors being parsed. Names may be empty, so an
+//! empty line is a line too and only the end of the text has no line.
 //!
-//! @param[in] argc the number of parameter passed on the command line
-//! @param[in] argv the list of arguments
+//! @param[in,out] pos where the line starts, moved to where the next one does
 //!
-//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//! @return the line, NUL-terminated in place, or NULL at the end of the text
 //!
-int main(int argc, char **argv)
+static char *sensor_next_line(char **pos)
 {
-    ts = time_usec() / 1000;
-    logfile(NULL, EUCA_LOG_TRACE, 4);
-    log_prefix_set("%T %L %t9 %m-24 %F-33 |");
-    LOGDEBUG("testing sensor.c with cache of size 2 and MAX_SENSOR_VALUES=%d\n", MAX_SENSOR_VALUES);
+    char *line = *pos;
+    char *nl = NULL;
 
-    long long intervalMs = 50000;
-    assert(sensor_init(NULL, NULL, 2, FALSE, NULL) == 0);
-    assert(sensor_state->max_resources > 0);
-    assert(sensor_state->used_resources == 0);
-    assert(0 != sensor_config(-1, 5000));
-    assert(0 != sensor_config(MAX_SENSOR_VALUES + 1, 5000));
-    assert(0 != sensor_config(1, 50));
-    assert(0 != sensor_config(1, 50000000000));
-    assert(0 == sensor_config(0, 50000));
-    assert(0 == sensor_config(1, 50000));
-    assert(0 == sensor_config(3, intervalMs));
+    if ((line == NULL) || (*line == '\0'))
+        return (NULL);
 
-#define GETSTAT_ITERS 10
-    // test the getstat function
-    getstat **stats = NULL;
-    for (int i = 1; i <= GETSTAT_ITERS; i++) {
-        if (i % 2) {
-            euca_this_component_name = "nc";
-        } else {
-            euca_this_component_name = "cc";
-        }
-        assert(getstat_generate(&stats) == EUCA_OK);
-        getstat *gs = getstat_find(stats, NULL);
-        if (gs != NULL) {
-            char id[1][MAX_SENSOR_NAME_LEN] = { "" };
-            char res[1][MAX_SENSOR_NAME_LEN] = { "" };
-            euca_strncpy(id[0], gs->instanceId, sizeof(id[0]));
-            assert(sensor_refresh_resources(id, res, 1) == EUCA_OK);
-        }
-        if (i % 101 == 0 || i % 102 == 0) {
-            LOGDEBUG("getstat_refresh() iteration %d/%d found %d instances\n", i, GETSTAT_ITERS, getstat_ninstances(stats));
-        }
+    if ((nl = strchr(line, '\n')) != NULL) {
+        *nl = '\0';
+        *pos = nl + 1;
+    } else {
+        *pos = line + strlen(line);
     }
-    char *anInstanceId = NULL;
-    if (stats) {
-        anInstanceId = stats[0]->instanceId;
+    return (line);
+}
+
+//!
+//! Parses the header and the name dictionary that start both batches and cursors
+//!
+//! @param[in,out] pos where the text starts, moved past the dictionary
+//! @param[in]     magic the expected first token of the header
+//! @param[out]    names the dictionary names, pointing into the text, which the caller frees
+//! @param[out]    namesLen the number of names in the dictionary
+//! @param[out]    count the number of records announced by the header
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR and EUCA_MEMORY_ERROR on failure
+//!
+static int sensor_parse_header(char **pos, const char *magic, char ***names, int *namesLen, int *count)
+{
+    int i = 0;
+    int used = 0;
+    char *line = NULL;
+
+    *names = NULL;
+    *namesLen = 0;
+    *count = 0;
+
+    if (((line = sensor_next_line(pos)) == NULL) || strncmp(line, magic, strlen(magic))
+        || (sscanf(line + strlen(magic), " %d %d%n", namesLen, count, &used) != 2) || (line[strlen(magic) + used] != '\0')
+        || (*namesLen < 0) || (*count < 0) || ((size_t) *namesLen > strlen(*pos))) {
+        *namesLen = 0;
+        return (EUCA_INVALID_ERROR);
     }
-    if (anInstanceId != NULL)
-        assert(getstat_find(stats, anInstanceId) != NULL);
 
-    euca_this_component_name = "ignore";    // set component name so that getstats won't get involved and won't put real sensor readings into sensor state
-    getstat_free(stats);
-    init_state(2);                     // clear out sensor state after previous experiments
-    assert(0 == sensor_config(3, intervalMs));
+    if ((*namesLen > 0) && ((*names = EUCA_ZALLOC(*namesLen, sizeof(char *))) == NULL)) {
+        *namesLen = 0;
+        return (EUCA_MEMORY_ERROR);
+    }
 
-    // test sensor_add_value and sensor_get_value
-    double val = 11.0;
-    for (int j = 0; j < 50; j++) {
-        long long sn = -1L;
-        int valLen = 0;
-        for (int i = 0; i < ((MAX_SENSOR_VALUES / 2) * (j + 1)); i++) {
-            sn += 1;
-            ts += intervalMs;
-            val += 1;
-            assert(0 == sensor_add_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", sn, ts, (sn % 2) ? TRUE : FALSE, val));
-            assert(0 == sensor_add_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", sn, ts, (sn % 2) ? TRUE : FALSE, val));  // should be a no-op
-            valLen++;
-            if (valLen > MAX_SENSOR_VALUES)
-                valLen = MAX_SENSOR_VALUES;
+    for (i = 0; i < *namesLen; i++) {
+        if (((*names)[i] = sensor_next_line(pos)) == NULL) {
+            EUCA_FREE(*names);
+            *namesLen = 0;
+            return (EUCA_INVALID_ERROR);
+        }
+    }
+    return (EUCA_OK);
+}
 
-            {
-                long long last_sn;
-                long long last_ts;
-                boolean last_available;
-                double last_val;
-                long long last_intervalMs;
-                int last_valLen;
+//!
+//! Parses the next integer of a record
+//!
+//! @param[in,out] pos where the integer starts, moved past it
+//! @param[out]    val the integer
+//!
+//! @return TRUE if there was an integer or FALSE otherwise
+//!
+static boolean sensor_parse_ll(char **pos, long long *val)
+{
+    char *end = NULL;
 
-                assert(0 == sensor_get_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
-                assert(last_sn == sn);
-                assert(last_ts == ts);
-                if (!(last_intervalMs == intervalMs)) {
-                    LOGERROR("bad\n");
+    errno = 0;
+    *val = strtoll(*pos, &end, 10);
+    if ((end == *pos) || (errno != 0) || ((*end != ' ') && (*end != '\0')))
+        return (FALSE);
+    *pos = end;
+    return (TRUE);
+}
+
+//!
+//! Builds the cursors that let an NC only send the sensor values which are not in the
+//! cache yet, with the next sequence number the cache expects for each dimension it holds
+//! values of. The cursors start with a dictionary of the names they use and are followed,
+//! for each resource found in the cache, by "R <name> <count>" and <count> lines of
+//! "<metric> <type> <dimension> <next sequence number>", names being dictionary indexes.
+//!
+//! @param[in]  resourceNames the resources to send cursors for
+//! @param[in]  resourceNamesLen the number of resources in resourceNames
+//! @param[out] cursors the cursors, which the caller frees
+//!
+//! @return EUCA_OK on success or EUCA_ERROR and EUCA_MEMORY_ERROR on failure
+//!
+//! @see sensor_encode_batch()
+//!
+int sensor_get_cursors(char **resourceNames, int resourceNamesLen, char **cursors)
+{
+    int r = 0;
+    int m = 0;
+    int c = 0;
+    int d = 0;
+    int n = 0;
+    int rc = EUCA_OK;
+    int resources = 0;
+    sensorText head = { 0 };
+    sensorText lines = { 0 };
+    sensorDict dict = { 0 };
+    const sensorResource *sr = NULL;
+    const sensorMetric *sm = NULL;
+    const sensorCounter *sc = NULL;
+    const sensorDimension *sd = NULL;
+
+    *cursors = NULL;
+    if ((sensor_state == NULL) || (sensor_state->initialized == FALSE))
+        return (EUCA_ERROR);
+
+    sem_p(state_sem);
+    for (r = 0; (r < resourceNamesLen) && (rc == EUCA_OK); r++) {
+        if ((sr = find_or_alloc_sr(FALSE, resourceNames[r], NULL, NULL)) == NULL)
+            continue;
+
+        for (n = 0, m = 0; m < sr->metricsLen; m++) {
+            for (c = 0; c < sr->metrics[m].countersLen; c++) {
+                for (d = 0; d < sr->metrics[m].counters[c].dimensionsLen; d++) {
+                    if (sr->metrics[m].counters[c].dimensions[d].valuesLen > 0)
+                        n++;
                 }
-                assert(last_available == (sn % 2) ? TRUE : FALSE);
-                assert(last_val == val);
-                assert(last_valLen == valLen);
             }
         }
-        intervalMs += 50000;
-        assert(0 == sensor_config(3, intervalMs));
+        if (n == 0)
+            continue;
+
+        if ((rc = sensor_text_append(&lines, "R %d %d\n", sensor_dict_index(&dict, sr->resourceName), n)) != EUCA_OK)
+            break;
+        for (m = 0; (m < sr->metricsLen) && (rc == EUCA_OK); m++) {
+            sm = sr->metrics + m;
+            for (c = 0; (c < sm->countersLen) && (rc == EUCA_OK); c++) {
+                sc = sm->counters + c;
+                for (d = 0; (d < sc->dimensionsLen) && (rc == EUCA_OK); d++) {
+                    sd = sc->dimensions + d;
+                    if (sd->valuesLen > 0) {
+                        rc = sensor_text_append(&lines, "%d %d %d %lld\n", sensor_dict_index(&dict, sm->metricName), sc->type,
+                                                sensor_dict_index(&dict, sd->dimensionName), (sd->sequenceNum + sd->valuesLen));
+                    }
+                }
+            }
+        }
+        resources++;
     }
+    sem_v(state_sem);
 
-    // add the "dummy" struct as a second resource
-    sensorResource **srs = EUCA_ZALLOC(sensor_state->max_resources, sizeof(sensorResource *));
-    assert(srs);
-    for (int i = 0; i < sensor_state->max_resources; i++) {
-        srs[i] = EUCA_ZALLOC(1, sizeof(sensorResource));
-        assert(srs[i]);
+    if (rc == EUCA_OK)
+        rc = dict.error;
+    if ((rc == EUCA_OK) && ((rc = sensor_text_append(&head, "%s %d %d\n%s%s", SENSOR_CURSORS_MAGIC, dict.namesLen, resources, SP(dict.text.buf), SP(lines.buf))) == EUCA_OK)) {
+        *cursors = head.buf;
+        head.buf = NULL;
+    }
+    EUCA_FREE(head.buf);
+    EUCA_FREE(lines.buf);
+    EUCA_FREE(dict.text.buf);
+    EUCA_FREE(dict.names);
+    return (rc);
+}
+
+//!
+//! Encodes sensor resources into a batch for the CC, leaving out of each dimension the
+//! values that the cursors say the CC has already. All resources are in the batch, even
+//! those without new values, so that they do not expire from the cache of the CC.
+//!
+//! The batch starts with a dictionary of the names it uses, one per line, and follows the
+//! structure of the resources, with "R <name> <type> <uuid> <metrics>", "M <name> <counters>"
+//! and "C <type> <interval> <dimensions>" lines, names being dictionary indexes. Each
+//! dimension is a "D <name> <sequence number> <count>" line followed by the timestamp of
+//! the first value, the deltas of the timestamps of the others and then the values. A
+//! value that is an integer, which most of them are, is the delta from the previous such
+//! value, any other value is "=" followed by the value and an unavailable value is "!".
+//!
+//! @param[in]  srs the sensor resources
+//! @param[in]  srsLen the number of resources in srs
+//! @param[in]  historySize the most values to send per dimension
+//! @param[in]  cursors the cursors of the CC or NULL to send the whole history
+//! @param[out] batch the batch, which the caller frees
+//!
+//! @return EUCA_OK on success or EUCA_ERROR, EUCA_INVALID_ERROR and EUCA_MEMORY_ERROR on failure
+//!
+//! @see sensor_get_cursors(), sensor_decode_batch()
+//!
+int sensor_encode_batch(sensorResource ** srs, int srsLen, int historySize, const char *cursors, char **batch)
+{
+    int i = 0;
+    int r = 0;
+    int m = 0;
+    int c = 0;
+    int d = 0;
+    int v = 0;
+    int k = 0;
+    int rc = EUCA_OK;
+    int first = 0;
+    int count = 0;
+    int namesLen = 0;
+    int groupsLen = 0;
+    int cursorsLen = 0;
+    int entriesLen = 0;
+    int resIdx = -1;
+    int metricIdx = -1;
+    int dimIdx = -1;
+    double val = 0.0;
+    long long prevTs = 0;
+    long long prevInt = 0;
+    long long nextSeq = 0;
+    char *pos = NULL;
+    char *line = NULL;
+    char *copy = NULL;
+    char **names = NULL;
+    sensorText head = { 0 };
+    sensorText lines = { 0 };
+    sensorDict dict = { 0 };
+    sensorCursor *entries = NULL;
+    sensorCursorGroup *groups = NULL;
+    const sensorResource *sr = NULL;
+    const sensorMetric *sm = NULL;
+    const sensorCounter *sc = NULL;
+    const sensorDimension *sd = NULL;
+    const sensorValue *sv = NULL;
+
+    *batch = NULL;
+    if ((historySize < 1) || (historySize > MAX_SENSOR_VALUES))
+        historySize = MAX_SENSOR_VALUES;
+
+    // load the cursors, grouped by resource as they were written
+    if (cursors != NULL) {
+        if ((copy = strdup(cursors)) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        pos = copy;
+        if ((rc = sensor_parse_header(&pos, SENSOR_CURSORS_MAGIC, &names, &namesLen, &groupsLen)) != EUCA_OK)
+            goto out;
+        if ((groupsLen > 0) && ((groups = EUCA_ZALLOC(groupsLen, sizeof(sensorCursorGroup))) == NULL)) {
+            rc = EUCA_MEMORY_ERROR;
+            goto out;
+        }
+        for (i = 0; i < groupsLen; i++) {
+            if (((line = sensor_next_line(&pos)) == NULL) || (line[0] != 'R') || (sscanf(line, "R %d %d", &(groups[i].resource), &count) != 2)
+                || (groups[i].resource < 0) || (groups[i].resource >= namesLen) || (count < 0) || ((size_t) count > strlen(pos))) {
+                rc = EUCA_INVALID_ERROR;
+                goto out;
+            }
+            if ((cursorsLen + count) > entriesLen) {
+                entriesLen = 2 * (cursorsLen + count);
+                if ((entries = EUCA_REALLOC(entries, entriesLen, sizeof(sensorCursor))) == NULL) {
+                    rc = EUCA_MEMORY_ERROR;
+                    goto out;
+                }
+            }
+            groups[i].first = cursorsLen;
+            groups[i].count = count;
+            for (k = 0; k < count; k++, cursorsLen++) {
+                if (((line = sensor_next_line(&pos)) == NULL) || (sscanf(line, "%d %d %d %lld", &(entries[cursorsLen].metric), &(entries[cursorsLen].type),
+                                                                       &(entries[cursorsLen].dimension), &(entries[cursorsLen].nextSeq)) != 4)
+                    || (entries[cursorsLen].metric < 0) || (entries[cursorsLen].metric >= namesLen)
+                    || (entries[cursorsLen].dimension < 0) || (entries[cursorsLen].dimension >= namesLen)) {
+                    rc = EUCA_INVALID_ERROR;
+                    goto out;
+                }
+            }
+        }
+    }
+
+    for (r = 0; (r < srsLen) && (rc == EUCA_OK); r++) {
+        sr = srs[r];
+        if ((sr->metricsLen < 0) || (sr->metricsLen > MAX_SENSOR_METRICS)) {
+            LOGERROR("inconsistency in sensor database (metricsLen=%d for %s)\n", sr->metricsLen, sr->resourceName);
+            rc = EUCA_ERROR;
+            break;
+        }
+
+        // cursors of this resource, if the CC has some
+        for (resIdx = -1, i = 0; (resIdx < 0) && (i < namesLen); i++) {
+            if (!strcmp(names[i], sr->resourceName))
+                resIdx = i;
+        }
+        for (i = 0; (resIdx >= 0) && (i < groupsLen) && (groups[i].resource != resIdx); i++) ;
+        first = (((resIdx >= 0) && (i < groupsLen)) ? groups[i].first : 0);
+        count = (((resIdx >= 0) && (i < groupsLen)) ? groups[i].count : 0);
+
+        rc = sensor_text_append(&lines, "R %d %d %d %d\n", sensor_dict_index(&dict, sr->resourceName), sensor_dict_index(&dict, sr->resourceType),
+                                sensor_dict_index(&dict, sr->resourceUuid), sr->metricsLen);
+        for (m = 0; (m < sr->metricsLen) && (rc == EUCA_OK); m++) {
+            sm = sr->metrics + m;
+            if ((sm->countersLen < 0) || (sm->countersLen > MAX_SENSOR_COUNTERS)) {
+                LOGERROR("inconsistency in sensor database (countersLen=%d for %s:%s)\n", sm->countersLen, sr->resourceName, sm->metricName);
+                rc = EUCA_ERROR;
+                break;
+            }
+
+            for (metricIdx = -1, i = 0; (count > 0) && (metricIdx < 0) && (i < namesLen); i++) {
+                if (!strcmp(names[i], sm->metricName))
+                    metricIdx = i;
+            }
+
+            rc = sensor_text_append(&lines, "M %d %d\n", sensor_dict_index(&dict, sm->metricName), sm->countersLen);
+            for (c = 0; (c < sm->countersLen) && (rc == EUCA_OK); c++) {
+                sc = sm->counters + c;
+                if ((sc->dimensionsLen < 0) || (sc->dimensionsLen > MAX_SENSOR_DIMENSIONS)) {
+                    LOGERROR("inconsistency in sensor database (dimensionsLen=%d for %s:%s:%s)\n", sc->dimensionsLen, sr->resourceName, sm->metricName,
+                             sensor_type2str(sc->type));
+                    rc = EUCA_ERROR;
+                    break;
+                }
+
+                rc = sensor_text_append(&lines, "C %d %lld %d\n", sc->type, sc->collectionIntervalMs, sc->dimensionsLen);
+                for (d = 0; (d < sc->dimensionsLen) && (rc == EUCA_OK); d++) {
+                    sd = sc->dimensions + d;
+                    if ((sd->valuesLen < 0) || (sd->valuesLen > MAX_SENSOR_VALUES)) {
+                        LOGERROR("inconsistency in sensor database (valuesLen=%d for %s:%s:%s:%s)\n", sd->valuesLen, sr->resourceName, sm->metricName,
+                                 sensor_type2str(sc->type), sd->dimensionName);
+                        rc = EUCA_ERROR;
+                        break;
+                    }
+
+                    // the latest historySize values, less those the CC has already unless the
+                    // CC expects values past ours, which happens when the sensor was reset
+                    v = ((sd->valuesLen > historySize) ? (sd->valuesLen - historySize) : 0);
+                    for (dimIdx = -1, i = 0; (metricIdx >= 0) && (dimIdx < 0) && (i < namesLen); i++) {
+                        if (!strcmp(names[i], sd->dimensionName))
+                            dimIdx = i;
+                    }
+                    for (k = first; (dimIdx >= 0) && (k < (first + count)); k++) {
+                        if ((entries[k].metric == metricIdx) && (entries[k].type == sc->type) && (entries[k].dimension == dimIdx)) {
+                            nextSeq = entries[k].nextSeq;
+                            if ((nextSeq > (sd->sequenceNum + v)) && (nextSeq <= (sd->sequenceNum + sd->valuesLen)))
+                                v = nextSeq - sd->sequenceNum;
+                            break;
+                        }
+                    }
+
+                    if ((rc = sensor_text_append(&lines, "D %d %lld %d", sensor_dict_index(&dict, sd->dimensionName), (sd->sequenceNum + v), (sd->valuesLen - v))) != EUCA_OK)
+                        break;
+                    for (k = v, prevTs = 0; (k < sd->valuesLen) && (rc == EUCA_OK); k++) {
+                        sv = sd->values + ((sd->firstValueIndex + k) % MAX_SENSOR_VALUES);
+                        rc = sensor_text_append(&lines, " %lld", (sv->timestampMs - prevTs));
+                        prevTs = sv->timestampMs;
+                    }
+                    for (k = v, prevInt = 0; (k < sd->valuesLen) && (rc == EUCA_OK); k++) {
+                        sv = sd->values + ((sd->firstValueIndex + k) % MAX_SENSOR_VALUES);
+                        val = sv->value + sd->shift_value;
+                        if (!sv->available || (val < 0)) {
+                            rc = sensor_text_append(&lines, " !");
+                        } else if ((val < SENSOR_BATCH_MAX_INT) && ((double)((long long)val) == val)) {
+                            rc = sensor_text_append(&lines, " %lld", ((long long)val - prevInt));
+                            prevInt = (long long)val;
+                        } else {
+                            rc = sensor_text_append(&lines, " =%.17g", val);
+                        }
+                    }
+                    if (rc == EUCA_OK)
+                        rc = sensor_text_append(&lines, "\n");
+                }
+            }
+        }
+    }
+
+    // a name that cannot be in the dictionary, which only a newline in it would do
+    if (rc == EUCA_OK)
+        rc = dict.error;
+
+    if ((rc == EUCA_OK) && ((rc = sensor_text_append(&head, "%s %d %d\n%s%s", SENSOR_BATCH_MAGIC, dict.namesLen, srsLen, SP(dict.text.buf), SP(lines.buf))) == EUCA_OK)) {
+        *batch = head.buf;
+        head.buf = NULL;
+    }
+
+out:
+    EUCA_FREE(head.buf);
+    EUCA_FREE(lines.buf);
+    EUCA_FREE(dict.text.buf);
+    EUCA_FREE(dict.names);
+    EUCA_FREE(entries);
+    EUCA_FREE(groups);
+    EUCA_FREE(names);
+    EUCA_FREE(copy);
+    return (rc);
+}
+
+//!
+//! Decodes a batch of sensor resources encoded by sensor_encode_batch(), for
+//! sensor_merge_records() to merge into the cache
+//!
+//! @param[in]  batch the batch
+//! @param[out] srs the sensor resources, which the caller frees along with each resource
+//! @param[out] srsLen the number of resources in srs
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR and EUCA_MEMORY_ERROR on failure
+//!
+//! @see sensor_encode_batch()
+//!
+int sensor_decode_batch(const char *batch, sensorResource *** srs, int *srsLen)
+{
+    int i = 0;
+    int r = 0;
+    int m = 0;
+    int c = 0;
+    int d = 0;
+    int v = 0;
+    int rc = EUCA_OK;
+    int used = 0;
+    int namesLen = 0;
+    int resourcesLen = 0;
+    int idx[3] = { 0 };
+    long long val = 0;
+    long long prevTs = 0;
+    long long prevInt = 0;
+    char *pos = NULL;
+    char *end = NULL;
+    char *line = NULL;
+    char *copy = NULL;
+    char **names = NULL;
+    sensorResource *sr = NULL;
+    sensorMetric *sm = NULL;
+    sensorCounter *sc = NULL;
+    sensorDimension *sd = NULL;
+
+    *srs = NULL;
+    *srsLen = 0;
+
+    if ((copy = strdup(batch)) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    pos = copy;
+    if ((rc = sensor_parse_header(&pos, SENSOR_BATCH_MAGIC, &names, &namesLen, &resourcesLen)) != EUCA_OK)
+        goto out;
+    if ((size_t) resourcesLen > strlen(pos)) {
+        rc = EUCA_INVALID_ERROR;
+        goto out;
+    }
+    if ((resourcesLen > 0) && ((*srs = EUCA_ZALLOC(resourcesLen, sizeof(sensorResource *))) == NULL)) {
+        rc = EUCA_MEMORY_ERROR;
+        goto out;
+    }
+#define VALID_NAME(_i)  (((_i) >= 0) && ((_i) < namesLen))
+
+    for (r = 0; r < resourcesLen; r++) {
+        if ((sr = (*srs)[r] = EUCA_SLAB_ZALLOC(&sensor_resource_slab)) == NULL) {
+            rc = EUCA_MEMORY_ERROR;
+            goto out;
+        }
+        (*srsLen)++;
+
+        if (((line = sensor_next_line(&pos)) == NULL) || (sscanf(line, "R %d %d %d %d", &idx[0], &idx[1], &idx[2], &(sr->metricsLen)) != 4)
+            || !VALID_NAME(idx[0]) || !VALID_NAME(idx[1]) || !VALID_NAME(idx[2]) || (sr->metricsLen < 0) || (sr->metricsLen > MAX_SENSOR_METRICS)) {
+            rc = EUCA_INVALID_ERROR;
+            goto out;
+        }
+        euca_strncpy(sr->resourceName, names[idx[0]], sizeof(sr->resourceName));
+        euca_strncpy(sr->resourceType, names[idx[1]], sizeof(sr->resourceType));
+        euca_strncpy(sr->resourceUuid, names[idx[2]], sizeof(sr->resourceUuid));
+
+        for (m = 0; m < sr->metricsLen; m++) {
+            sm = sr->metrics + m;
+            if (((line = sensor_next_line(&pos)) == NULL) || (sscanf(line, "M %d %d", &idx[0], &(sm->countersLen)) != 2)
+                || !VALID_NAME(idx[0]) || (sm->countersLen < 0) || (sm->countersLen > MAX_SENSOR_COUNTERS)) {
+                rc = EUCA_INVALID_ERROR;
+                goto out;
+            }
+            euca_strncpy(sm->metricName, names[idx[0]], sizeof(sm->metricName));
+
+            for (c = 0; c < sm->countersLen; c++) {
+                sc = sm->counters + c;
+                if (((line = sensor_next_line(&pos)) == NULL)
+                    || (sscanf(line, "C %d %lld %d", &idx[0], &(sc->collectionIntervalMs), &(sc->dimensionsLen)) != 3)
+                    || (idx[0] <= SENSOR_UNUSED) || (idx[0] > SENSOR_LATEST) || (sc->dimensionsLen < 0) || (sc->dimensionsLen > MAX_SENSOR_DIMENSIONS)) {
+                    rc = EUCA_INVALID_ERROR;
+                    goto out;
+                }
+                sc->type = idx[0];
+
+                for (d = 0; d < sc->dimensionsLen; d++) {
+                    sd = sc->dimensions + d;
+                    if (((line = sensor_next_line(&pos)) == NULL)
+                        || (sscanf(line, "D %d %lld %d%n", &idx[0], &(sd->sequenceNum), &(sd->valuesLen), &used) != 3)
+                        || !VALID_NAME(idx[0]) || (sd->valuesLen < 0) || (sd->valuesLen > MAX_SENSOR_VALUES)) {
+                        rc = EUCA_INVALID_ERROR;
+                        goto out;
+                    }
+                    euca_strncpy(sd->dimensionName, names[idx[0]], sizeof(sd->dimensionName));
+
+                    line += used;
+                    for (v = 0, prevTs = 0; v < sd->valuesLen; v++) {
+                        if ((*(line++) != ' ') || !sensor_parse_ll(&line, &val)) {
+                            rc = EUCA_INVALID_ERROR;
+                            goto out;
+                        }
+                        sd->values[v].timestampMs = prevTs = prevTs + val;
+                    }
+                    for (v = 0, prevInt = 0; v < sd->valuesLen; v++) {
+                        if (*(line++) != ' ') {
+                            rc = EUCA_INVALID_ERROR;
+                            goto out;
+                        }
+                        if (*line == '!') {
+                            // same as an unset value coming through copy_sensor_value_from_adb()
+                            sd->values[v].value = -99.99;
+                            sd->values[v].available = 0;
+                            line++;
+                        } else if (*line == '=') {
+                            sd->values[v].value = strtod(++line, &end);
+                            sd->values[v].available = 1;
+                            if ((end == line) || ((*end != ' ') && (*end != '\0'))) {
+                                rc = EUCA_INVALID_ERROR;
+                                goto out;
+                            }
+                            line = end;
+                        } else if (sensor_parse_ll(&line, &val)) {
+                            sd->values[v].value = (double)(prevInt += val);
+                            sd->values[v].available = 1;
+                        } else {
+                            rc = EUCA_INVALID_ERROR;
+                            goto out;
+                        }
+                    }
+                    if (*line != '\0') {
+                        rc = EUCA_INVALID_ERROR;
+                        goto out;
+                    }
+                }
+            }
+        }
+    }
+#undef VALID_NAME
+
+out:
+    if (rc != EUCA_OK) {
+        LOGERROR("failed to decode batch of sensor resources (error=%d at resource %d of %d)\n", rc, *srsLen, resourcesLen);
+        for (i = 0; i < *srsLen; i++) {
+            EUCA_SLAB_FREE(&sensor_resource_slab, (*srs)[i]);
+        }
+        EUCA_FREE(*srs);
+        *srsLen = 0;
+    }
+    EUCA_FREE(names);
+    EUCA_FREE(copy);
+    return (rc);
+}
+
+#ifdef _UNIT_TEST
+//!
+//!
+//!
+static void dump_sensor_cache(void)
+{
+    sensorResource **srs = EUCA_ZALLOC(sensor_state->max_resources, sizeof(sensorResource *));
+    for (int i = 0; i < sensor_state->max_resources; i++) {
+        srs[i] = &(sensor_state->resources[i]);
+    }
+    log_sensor_resources("whole cache", srs, sensor_state->max_resources);
+    EUCA_FREE(srs);
+}
+
+//!
+//!
+//!
+//! @param[out] srs
+//! @param[in]  srsLen
+//!
+static void clear_srs(sensorResource ** srs, int srsLen)
+{
+    for (int i = 0; i < srsLen; i++) {
+        bzero(srs[i], sizeof(sensorResource));
+    }
+}
+
+#ifdef _BENCHMARK
+//!
+//! Microseconds on the monotonic clock
+//!
+//! @return the current time in microseconds
+//!
+static long long bench_usec(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000);
+}
+
+//!
+//! Records the outcome of one benchmarked call
+//!
+//! @param[in,out] s the samples of the operation
+//! @param[in]     usec latency of the call
+//! @param[in]     ok set to TRUE if the call succeeded
+//!
+static void bench_add(bench_samples * s, long long usec, int ok)
+{
+    long long *grown = NULL;
+
+    if (!ok) {
+        s->failed++;
+        return;
+    }
+
+    if (s->len == s->size) {
+        if ((grown = EUCA_REALLOC(s->usec, ((s->size * 2) + 64), sizeof(long long))) == NULL) {
+            s->failed++;
+            return;
+        }
+        s->usec = grown;
+        s->size = (s->size * 2) + 64;
+    }
+    s->usec[s->len++] = usec;
+}
+
+//!
+//! Adds the samples of 'from' to 'to' and releases those of 'from'
+//!
+//! @param[in,out] to
+//! @param[in,out] from
+//!
+static void bench_merge(bench_samples * to, bench_samples * from)
+{
+    for (int i = 0; i < from->len; i++)
+        bench_add(to, from->usec[i], TRUE);
+    to->failed += from->failed;
+    EUCA_FREE(from->usec);
+    bzero(from, sizeof(bench_samples));
+}
+
+//!
+//! qsort() comparator of latencies
+//!
+static int bench_compare(const void *a, const void *b)
+{
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+
+    return ((x > y) - (x < y));
+}
+
+//!
+//! Prints one result line and resets the samples. Every line starts with 'sensor_bench'
+//! and only holds key=value pairs, so results can be compared across runs and across
+//! builds with different MAX_SENSOR_VALUES with standard tools.
+//!
+//! @param[in]     out stream to print to
+//! @param[in]     op name of the operation
+//! @param[in]     config key=value pairs describing the configuration
+//! @param[in]     threads number of threads that made the calls
+//! @param[in,out] s the samples, with elapsed_usec set to the wall-clock time of the phase
+//!
+static void bench_report(FILE * out, const char *op, const char *config, int threads, bench_samples * s)
+{
+    long long total = 0;
+
+    if ((s->len + s->failed) == 0)
+        return;
+
+    qsort(s->usec, s->len, sizeof(long long), bench_compare);
+    for (int i = 0; i < s->len; i++)
+        total += s->usec[i];
+
+#define _PCT(_F)                       ((s->len > 0) ? s->usec[MIN(s->len - 1, (int)((_F) * s->len))] : 0LL)
+    fprintf(out, "sensor_bench op=%s %s threads=%d calls=%d failed=%d ops_per_sec=%.1f mean_us=%lld p50_us=%lld p90_us=%lld p99_us=%lld max_us=%lld\n",
+            op, config, threads, s->len + s->failed, s->failed, ((s->elapsed_usec > 0) ? (s->len * 1000000.0 / s->elapsed_usec) : 0.0),
+            ((s->len > 0) ? (total / s->len) : 0LL), _PCT(0.50), _PCT(0.90), _PCT(0.99), _PCT(1.0));
+#undef _PCT
+    fflush(out);
+
+    EUCA_FREE(s->usec);
+    bzero(s, sizeof(bench_samples));
+}
+
+//!
+//! Parses a comma-separated list of positive integers
+//!
+//! @param[in]  list the list
+//! @param[out] values array receiving the integers
+//! @param[in]  size room in values[]
+//!
+//! @return the number of integers parsed or -1 if the list is invalid
+//!
+static int bench_parse_list(const char *list, int *values, int size)
+{
+    int len = 0;
+    char *end = NULL;
+    const char *p = list;
+
+    while (*p != '\0') {
+        if (len == size)
+            return (-1);
+        if (((values[len++] = strtol(p, &end, 10)) < 1) || ((*end != ',') && (*end != '\0')))
+            return (-1);
+        p = ((*end == ',') ? (end + 1) : end);
+    }
+    return (len);
+}
+
+//!
+//! Names the dimensions of the benchmark metrics like those of an instance: its root
+//! and ephemeral disks, then its volumes
+//!
+//! @param[in]  d index of the dimension
+//! @param[out] name buffer receiving the name
+//! @param[in]  len size of the buffer
+//!
+static void bench_dimension(int d, char *name, int len)
+{
+    if (d == 0) {
+        euca_strncpy(name, "root", len);
+    } else if (d == 1) {
+        euca_strncpy(name, "ephemeral0", len);
+    } else {
+        snprintf(name, len, "vol-%08X", d);
+    }
+}
+
+//!
+//! @param[in] m index of the metric in bench_metrics[]
+//!
+//! @return the counter type of the metric
+//!
+static int bench_counter_type(int m)
+{
+    return ((m == 0) ? SENSOR_AVERAGE : SENSOR_SUMMATION);
+}
+
+//!
+//! Adds the next value of every dimension of a resource with sensor_add_value(),
+//! timing every call
+//!
+//! @param[in]     r index of the resource
+//! @param[in,out] s the samples of sensor_add_value()
+//!
+//! @return the number of failed calls
+//!
+static int bench_write_round(int r, bench_samples * s)
+{
+    int rc = 0;
+    int errors = 0;
+    long long sn = bench_seq[r]++;
+    long long start = 0;
+    char dimension[MAX_SENSOR_NAME_LEN] = "";
+
+    for (int m = 0; m < bench_metrics_len; m++) {
+        for (int d = 0; d < bench_dimensions; d++) {
+            bench_dimension(d, dimension, sizeof(dimension));
+            start = bench_usec();
+            rc = sensor_add_value(bench_names[r], bench_metrics[m], bench_counter_type(m), dimension, sn, (bench_ts0 + sn * BENCH_INTERVAL_MS), TRUE,
+                                  (double)(sn * (m + 1) + d));
+            bench_add(s, (bench_usec() - start), (rc == EUCA_OK));
+            if (rc != EUCA_OK)
+                errors++;
+        }
+    }
+    return (errors);
+}
+
+//!
+//! Fills a record with the next values of every dimension of a resource, as the CC
+//! receives them from an NC
+//!
+//! @param[in]  r index of the resource
+//! @param[in]  values number of new values of every dimension
+//! @param[out] sr the record
+//!
+static void bench_fill_record(int r, int values, sensorResource * sr)
+{
+    long long sn = 0;
+
+    bzero(sr, sizeof(sensorResource));
+    euca_strncpy(sr->resourceName, bench_names[r], sizeof(sr->resourceName));
+    euca_strncpy(sr->resourceType, "instance", sizeof(sr->resourceType));
+    sr->metricsLen = bench_metrics_len;
+    for (int m = 0; m < bench_metrics_len; m++) {
+        sensorMetric *sm = sr->metrics + m;
+        sensorCounter *sc = sm->counters;
+        euca_strncpy(sm->metricName, bench_metrics[m], sizeof(sm->metricName));
+        sm->countersLen = 1;
+        sc->type = bench_counter_type(m);
+        sc->collectionIntervalMs = BENCH_INTERVAL_MS;
+        sc->dimensionsLen = bench_dimensions;
+        for (int d = 0; d < bench_dimensions; d++) {
+            sensorDimension *sd = sc->dimensions + d;
+            bench_dimension(d, sd->dimensionName, sizeof(sd->dimensionName));
+            sd->sequenceNum = bench_seq[r];
+            sd->valuesLen = values;
+            for (int v = 0; v < values; v++) {
+                sn = bench_seq[r] + v;
+                sd->values[v].timestampMs = bench_ts0 + sn * BENCH_INTERVAL_MS;
+                sd->values[v].value = (double)(sn * (m + 1) + d);
+                sd->values[v].available = 1;
+            }
+        }
+    }
+    bench_seq[r] += values;
+}
+
+//!
+//! Stats collector of the benchmark, which reports one value for every dimension of every
+//! resource, like the native collector of the NC
+//!
+//! @param[in,out] pstats
+//!
+//! @return EUCA_OK on success or the error of getstat_append()
+//!
+static int bench_collector(getstat *** pstats)
+{
+    int rc = 0;
+    long long now = time_usec() / 1000;
+    char dimension[MAX_SENSOR_NAME_LEN] = "";
+
+    for (int r = 0; r < bench_resources; r++) {
+        for (int m = 0; m < bench_metrics_len; m++) {
+            for (int d = 0; d < bench_dimensions; d++) {
+                bench_dimension(d, dimension, sizeof(dimension));
+                if ((rc = getstat_append(pstats, bench_names[r], now, bench_metrics[m], bench_counter_type(m), dimension, (double)(r + m + d))) != EUCA_OK)
+                    return (rc);
+            }
+        }
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Thread of the concurrent phase: adds values to, reads or merges records into the cache
+//!
+//! @param[in] ptr the bench_worker of this thread
+//!
+//! @return Always NULL
+//!
+static void *bench_worker_thread(void *ptr)
+{
+    int rc = 0;
+    int r = 0;
+    long long start = 0;
+    bench_worker *w = ((bench_worker *) ptr);
+
+    switch (w->role) {
+    case BENCH_WRITER:
+        r = w->slice;
+        for (int i = 0; i < w->ops; i += (bench_metrics_len * bench_dimensions)) {
+            bench_write_round(r, &(w->s));
+            if ((r += w->slices) >= bench_resources)
+                r = w->slice;
+        }
+        break;
+    case BENCH_READER:
+        for (int i = 0; i < w->ops; i++) {
+            r = rand_r(&(w->seed)) % bench_resources;
+            start = bench_usec();
+            rc = sensor_get_instance_data(bench_names[r], NULL, 0, w->srs, w->srsLen);
+            bench_add(&(w->s), (bench_usec() - start), (rc == EUCA_OK));
+        }
+        break;
+    case BENCH_MERGER:
+        for (int i = 0; i < w->ops; i++) {
+            for (int j = 0; j < w->srsLen; j++)
+                bench_fill_record((w->slice + j * w->slices), w->values, w->srs[j]);
+            start = bench_usec();
+            rc = sensor_merge_records(w->srs, w->srsLen, TRUE);
+            bench_add(&(w->s), (bench_usec() - start), (rc == EUCA_OK));
+        }
+        break;
+    default:
+        break;
+    }
+    return (NULL);
+}
+
+//!
+//! @param[in] len number of records
+//!
+//! @return an array of 'len' zeroed records or NULL on failure
+//!
+static sensorResource **bench_alloc_srs(int len)
+{
+    sensorResource **srs = NULL;
+
+    if ((srs = EUCA_ZALLOC(len, sizeof(sensorResource *))) == NULL)
+        return (NULL);
+
+    for (int i = 0; i < len; i++) {
+        if ((srs[i] = EUCA_ZALLOC(1, sizeof(sensorResource))) == NULL) {
+            bench_free_srs(srs, i);
+            return (NULL);
+        }
+    }
+    return (srs);
+}
+
+//!
+//! @param[in] srs the array of records to free
+//! @param[in] len number of records
+//!
+static void bench_free_srs(sensorResource ** srs, int len)
+{
+    if (srs == NULL)
+        return;
+
+    for (int i = 0; i < len; i++)
+        EUCA_FREE(srs[i]);
+    EUCA_FREE(srs);
+}
+
+//!
+//! Installs a euca_rootwrap that does nothing under a temporary $EUCALYPTUS, so that
+//! sensor_refresh_resources() spawns the getstats_net.pl command as it does on the NC,
+//! without the real script or the privileges it needs
+//!
+//! @param[out] dir buffer receiving the temporary $EUCALYPTUS
+//! @param[in]  len size of the buffer
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int bench_stub_rootwrap(char *dir, int len)
+{
+    char path[EUCA_MAX_PATH] = "";
+    FILE *f = NULL;
+
+    euca_strncpy(dir, "/tmp/bench_sensor-XXXXXX", len);
+    if (mkdtemp(dir) == NULL)
+        return (EUCA_ERROR);
+
+    snprintf(path, sizeof(path), EUCALYPTUS_LIBEXEC_DIR "/euca_rootwrap", dir);
+    for (char *p = strchr(path + strlen(dir) + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if ((mkdir(path, 0755) != 0) && (errno != EEXIST))
+            return (EUCA_ERROR);
+        *p = '/';
+    }
+
+    if ((f = fopen(path, "w")) == NULL)
+        return (EUCA_ERROR);
+    fprintf(f, "#!/bin/sh\nexit 0\n");
+    fclose(f);
+    if (chmod(path, 0755) != 0)
+        return (EUCA_ERROR);
+
+    setenv(EUCALYPTUS_ENV_VAR_NAME, dir, 1);
+    return (EUCA_OK);
+}
+
+//!
+//! Removes what bench_stub_rootwrap() installed
+//!
+//! @param[in] dir the temporary $EUCALYPTUS
+//!
+static void bench_remove_stub(const char *dir)
+{
+    char *p = NULL;
+    char path[EUCA_MAX_PATH] = "";
+
+    snprintf(path, sizeof(path), EUCALYPTUS_LIBEXEC_DIR "/euca_rootwrap", dir);
+    unlink(path);
+    while (((p = strrchr(path, '/')) != NULL) && (p > (path + strlen(dir)))) {
+        *p = '\0';
+        rmdir(path);
+    }
+    rmdir(dir);
+}
+
+//!
+//! Benchmarks one configuration of the cache. Serially, it times the additions of values
+//! until the history of every dimension wraps, single-resource and whole-cache reads, the
+//! encoding and decoding of a batch with 'history' values per dimension and merges of
+//! records with as many new values. Then 'writers', 'readers' and 'mergers' threads
+//! compete for the cache. Last, it times sensor_refresh_resources() against a native
+//! collector, the same update of the cache without the spawning of getstats_net.pl and
+//! sensor_expire_cache_entries(), both when nothing and when everything expires.
+//!
+//! @param[in] out stream to print the results to
+//! @param[in] resources number of resources in the cache
+//! @param[in] history history size given to sensor_config()
+//! @param[in] writers number of threads adding values in the concurrent phase
+//! @param[in] readers number of threads reading resources in the concurrent phase
+//! @param[in] mergers number of threads merging records in the concurrent phase
+//! @param[in] ops number of calls by every thread of the concurrent phase
+//!
+//! @return the number of errors
+//!
+static int bench_configuration(FILE * out, int resources, int history, int writers, int readers, int mergers, int ops)
+{
+    int rc = 0;
+    int errors = 0;
+    int decodedLen = 0;
+    int batch_bytes = 0;
+    int slices = writers + mergers;
+    int threads = writers + readers + mergers;
+    long long start = 0;
+    long long phase = 0;
+    long long last = 0;
+    char *batch = NULL;
+    char config[256] = "";
+    char serial[320] = "";
+    char concurrent[384] = "";
+    int missing = 0;
+    getstat **stats = NULL;
+    sensorResource **srs = NULL;
+    sensorResource **decoded = NULL;
+    bench_worker *workers = NULL;
+    bench_samples s = { 0 };
+    bench_samples by_role[3] = { {0} };
+
+    snprintf(config, sizeof(config), "resources=%d history=%d max_values=%d metrics=%d dimensions=%d", resources, history, MAX_SENSOR_VALUES, bench_metrics_len,
+             bench_dimensions);
+    snprintf(serial, sizeof(serial), "phase=serial %s", config);
+    snprintf(concurrent, sizeof(concurrent), "phase=concurrent %s writers=%d readers=%d mergers=%d", config, writers, readers, mergers);
+
+    init_state(resources);             // an empty cache for every configuration
+    if ((sensor_config(history, BENCH_INTERVAL_MS) != EUCA_OK) || ((srs = bench_alloc_srs(resources)) == NULL)) {
+        fprintf(out, "sensor_bench op=setup %s skipped=1\n", config);
+        return (1);
+    }
+    bench_resources = resources;
+    for (int r = 0; r < resources; r++) {
+        snprintf(bench_names[r], MAX_SENSOR_NAME_LEN, "i-%08X", (r + 1));
+        bench_seq[r] = 0;
+    }
+
+    // additions of values to an empty cache, until the history of every dimension wraps around
+    phase = bench_usec();
+    for (int v = 0; v <= MAX_SENSOR_VALUES; v++) {
+        for (int r = 0; r < resources; r++)
+            errors += bench_write_round(r, &s);
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    bench_report(out, "add_value", serial, 1, &s);
+
+    // reads of single resources, through the lookup index
+    phase = bench_usec();
+    for (int i = 0; i < (resources * BENCH_READS_PER_RESOURCE); i++) {
+        start = bench_usec();
+        rc = sensor_get_instance_data(bench_names[random() % resources], NULL, 0, srs, 1);
+        bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "get_instance", serial, 1, &s);
+
+    // reads of the whole cache, as when the CC polls the NC
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_POLLS; i++) {
+        start = bench_usec();
+        rc = sensor_get_instance_data(NULL, NULL, 0, srs, resources);
+        bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "get_all", serial, 1, &s);
+
+    // encodings of the whole cache with the configured history, and their decodings
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_POLLS; i++) {
+        EUCA_FREE(batch);
+        start = bench_usec();
+        rc = sensor_encode_batch(srs, resources, history, NULL, &batch);
+        bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "encode", serial, 1, &s);
+
+    if (batch != NULL) {
+        batch_bytes = strlen(batch);
+        phase = bench_usec();
+        for (int i = 0; i < BENCH_POLLS; i++) {
+            start = bench_usec();
+            rc = sensor_decode_batch(batch, &decoded, &decodedLen);
+            bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+            bench_free_srs(decoded, decodedLen);
+            decoded = NULL;
+            decodedLen = 0;
+        }
+        s.elapsed_usec = bench_usec() - phase;
+        errors += s.failed;
+        bench_report(out, "decode", serial, 1, &s);
+        EUCA_FREE(batch);
+    }
+
+    // merges of records that each bring 'history' new values of every dimension
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_POLLS; i++) {
+        for (int r = 0; r < resources; r++)
+            bench_fill_record(r, history, srs[r]);
+        start = bench_usec();
+        rc = sensor_merge_records(srs, resources, TRUE);
+        bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "merge", serial, 1, &s);
+
+    // writers and mergers own disjoint slices of the resources while readers read any of them
+    if ((threads > 0) && ((workers = EUCA_ZALLOC(threads, sizeof(bench_worker))) != NULL)) {
+        phase = bench_usec();
+        for (int t = 0; t < threads; t++) {
+            bench_worker *w = workers + t;
+            w->role = ((t < writers) ? BENCH_WRITER : ((t < slices) ? BENCH_MERGER : BENCH_READER));
+            w->slice = ((t < slices) ? t : 0);
+            w->slices = slices;
+            w->values = history;
+            w->ops = ops;
+            w->seed = random();
+            if ((w->role != BENCH_READER) && (w->slice >= resources))
+                continue;              // more slices than resources
+            if (w->role == BENCH_MERGER) {
+                w->srsLen = (resources - w->slice + slices - 1) / slices;
+                w->ops = MAX(1, ops / (w->srsLen * bench_metrics_len * bench_dimensions));
+            } else if (w->role == BENCH_READER) {
+                w->srsLen = 1;
+            }
+            if ((w->srsLen > 0) && ((w->srs = bench_alloc_srs(w->srsLen)) == NULL)) {
+                errors++;
+                continue;
+            }
+            if (pthread_create(&(w->thread), NULL, bench_worker_thread, w) != 0) {
+                errors++;
+                continue;
+            }
+            w->started = TRUE;
+        }
+        for (int t = 0; t < threads; t++) {
+            bench_worker *w = workers + t;
+            if (w->started)
+                pthread_join(w->thread, NULL);
+            bench_merge(&(by_role[w->role]), &(w->s));
+            bench_free_srs(w->srs, w->srsLen);
+        }
+        for (int i = 0; i < 3; i++) {
+            by_role[i].elapsed_usec = bench_usec() - phase;
+            errors += by_role[i].failed;
+        }
+        bench_report(out, "add_value", concurrent, writers, &(by_role[BENCH_WRITER]));
+        bench_report(out, "get_instance", concurrent, readers, &(by_role[BENCH_READER]));
+        bench_report(out, "merge", concurrent, mergers, &(by_role[BENCH_MERGER]));
+        EUCA_FREE(workers);
+    }
+
+    // refreshes from a native collector, continuing the sequence numbers of the resources
+    for (int r = 0; r < resources; r++)
+        seq_num = MAX(seq_num, bench_seq[r]);
+    euca_this_component_name = "nc";
+    sensor_set_stats_collector(bench_collector);
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_POLLS; i++) {
+        start = bench_usec();
+        rc = sensor_refresh_resources(bench_names, bench_aliases, resources);
+        bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "refresh", serial, 1, &s);
+
+    // the same collection and update of the cache, without spawning getstats_net.pl
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_POLLS; i++) {
+        stats = NULL;
+        start = bench_usec();
+        if ((rc = bench_collector(&stats)) == EUCA_OK) {
+            getstat_merge(stats, bench_names, bench_aliases, resources, &missing);
+            seq_num++;
+        }
+        getstat_free(stats);
+        bench_add(&s, (bench_usec() - start), (rc == EUCA_OK));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "ingest", serial, 1, &s);
+    sensor_set_stats_collector(NULL);
+    euca_this_component_name = "ignore";
+    for (int r = 0; r < resources; r++)
+        bench_seq[r] = seq_num;
+
+    // expiration passes over a fresh cache, which expire nothing
+    phase = bench_usec();
+    for (int i = 0; i < BENCH_SCANS; i++) {
+        sem_p(state_sem);
+        start = bench_usec();
+        rc = sensor_expire_cache_entries();
+        last = bench_usec() - start;
+        sem_v(state_sem);
+        bench_add(&s, last, (rc == 0));
+    }
+    s.elapsed_usec = bench_usec() - phase;
+    errors += s.failed;
+    bench_report(out, "expire_scan", serial, 1, &s);
+
+    // expiration passes over a stale cache, which expire everything, the cache being refilled in between
+    // (out of the throughput, which only counts the time spent expiring)
+    for (int i = 0; i < BENCH_EXPIRATIONS; i++) {
+        sem_p(state_sem);
+        for (int r = 0; r < sensor_state->max_resources; r++) {
+            if (!is_empty_sr(sensor_state->resources + r))
+                sensor_state->resources[r].timestamp = 1;
+        }
+        start = bench_usec();
+        rc = sensor_expire_cache_entries();
+        last = bench_usec() - start;
+        sem_v(state_sem);
+        bench_add(&s, last, (rc == resources));
+        s.elapsed_usec += last;
+
+        for (int r = 0; r < resources; r++)
+            bench_fill_record(r, 1, srs[r]);
+        if (sensor_merge_records(srs, resources, TRUE) != EUCA_OK)
+            errors++;
+    }
+    errors += s.failed;
+    bench_report(out, "expire", serial, 1, &s);
+
+    // what the configuration costs in memory and on the wire
+    fprintf(out, "sensor_bench op=footprint %s resource_bytes=%lu cache_kb=%lu batch_bytes=%d\n", config, (unsigned long)sizeof(sensorResource),
+            (unsigned long)(SENSOR_CACHE_SIZE(resources) / 1024), batch_bytes);
+    fflush(out);
+
+    bench_free_srs(srs, resources);
+    return (errors);
+}
+
+//!
+//! Runs the sensor benchmarks over every combination of history size and resource count.
+//!
+//! Usage: bench_sensor [-n resources] [-H history] [-m metrics] [-d dimensions] [-w writers]
+//! [-r readers] [-g mergers] [-k ops] [-o file], where resources and history are comma-separated
+//! lists. Results go to stdout or the given file, one 'sensor_bench' line per operation. The
+//! history sizes are bounded by MAX_SENSOR_VALUES, which is set when building the benchmark.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return the number of errors
+//!
+static int do_benchmark(int argc, char **argv)
+{
+    int ch = 0;
+    int errors = 0;
+    int counts_len = 0;
+    int history_len = 0;
+    int max_resources = 0;
+    int metrics = BENCH_DEFAULT_METRICS;
+    int dimensions = BENCH_DEFAULT_DIMENSIONS;
+    int writers = BENCH_DEFAULT_WRITERS;
+    int readers = BENCH_DEFAULT_READERS;
+    int mergers = BENCH_DEFAULT_MERGERS;
+    int ops = BENCH_DEFAULT_OPS;
+    int counts[BENCH_MAX_LIST] = { 0 };
+    int history[BENCH_MAX_LIST] = { 0 };
+    char stub[EUCA_MAX_PATH] = "";
+    char *counts_opt = BENCH_DEFAULT_RESOURCES;
+    char *history_opt = BENCH_DEFAULT_HISTORY;
+    FILE *out = stdout;
+
+    while ((ch = getopt(argc, argv, "n:H:m:d:w:r:g:k:o:")) != -1) {
+        switch (ch) {
+        case 'n':
+            counts_opt = optarg;
+            break;
+        case 'H':
+            history_opt = optarg;
+            break;
+        case 'm':
+            metrics = atoi(optarg);
+            break;
+        case 'd':
+            dimensions = atoi(optarg);
+            break;
+        case 'w':
+            writers = atoi(optarg);
+            break;
+        case 'r':
+            readers = atoi(optarg);
+            break;
+        case 'g':
+            mergers = atoi(optarg);
+            break;
+        case 'k':
+            ops = atoi(optarg);
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "a")) == NULL) {
+                printf("ERROR: failed to open %s\n", optarg);
+                return (1);
+            }
+            break;
+        default:
+            printf("Usage: bench_sensor [-n resources] [-H history] [-m metrics] [-d dimensions] [-w writers] [-r readers] [-g mergers] [-k ops] [-o file]\n");
+            return (1);
+        }
+    }
+
+    if (((counts_len = bench_parse_list(counts_opt, counts, BENCH_MAX_LIST)) < 1) || ((history_len = bench_parse_list(history_opt, history, BENCH_MAX_LIST)) < 1)) {
+        printf("ERROR: resource counts and history sizes must be comma-separated positive integers\n");
+        return (1);
+    }
+    if ((metrics < 1) || (dimensions < 1) || (writers < 0) || (readers < 0) || (mergers < 0) || ((writers + readers + mergers) > BENCH_MAX_THREADS) || (ops < 1)) {
+        printf("ERROR: metrics, dimensions and ops must be positive and there may be up to %d threads\n", BENCH_MAX_THREADS);
+        return (1);
+    }
+    bench_metrics_len = MIN(metrics, MIN(MAX_SENSOR_METRICS, (int)(sizeof(bench_metrics) / sizeof(bench_metrics[0]))));
+    bench_dimensions = MIN(dimensions, MAX_SENSOR_DIMENSIONS);
+    for (int i = 0; i < counts_len; i++) {
+        counts[i] = MIN(counts[i], BENCH_MAX_RESOURCES);
+        max_resources = MAX(max_resources, counts[i]);
+    }
+
+    bench_names = EUCA_ZALLOC(max_resources, MAX_SENSOR_NAME_LEN);
+    bench_aliases = EUCA_ZALLOC(max_resources, MAX_SENSOR_NAME_LEN);
+    bench_seq = EUCA_ZALLOC(max_resources, sizeof(long long));
+    if ((bench_names == NULL) || (bench_aliases == NULL) || (bench_seq == NULL) || (bench_stub_rootwrap(stub, sizeof(stub)) != EUCA_OK)
+        || (sensor_init(NULL, NULL, max_resources, FALSE, NULL) != EUCA_OK)) {
+        printf("ERROR: failed to set up the benchmark\n");
+        errors++;
+        goto cleanup;
+    }
+    sensor_suspend_polling();          // the sensor thread stays out of the timings
+    bench_ts0 = time_usec() / 1000;
+
+    for (int h = 0; h < history_len; h++) {
+        if (history[h] > MAX_SENSOR_VALUES) {
+            fprintf(out, "sensor_bench op=setup history=%d max_values=%d skipped=1\n", history[h], MAX_SENSOR_VALUES);
+            continue;
+        }
+        for (int i = 0; i < counts_len; i++) {
+            errors += bench_configuration(out, counts[i], history[h], writers, readers, mergers, ops);
+        }
+    }
+
+cleanup:
+    if (stub[0] != '\0')
+        bench_remove_stub(stub);
+    EUCA_FREE(bench_names);
+    EUCA_FREE(bench_aliases);
+    EUCA_FREE(bench_seq);
+    if (out != stdout)
+        fclose(out);
+    return (errors);
+}
+#endif /* _BENCHMARK */
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int main(int argc, char **argv)
+{
+    ts = time_usec() / 1000;
+    logfile(NULL, EUCA_LOG_TRACE, 4);
+
+#ifdef _BENCHMARK
+    logfile(NULL, EUCA_LOG_WARN, 4);   // tracing every call would dominate the timings
+    exit(do_benchmark(argc, argv));
+#endif /* _BENCHMARK */
+
+    log_prefix_set("%T %L %t9 %m-24 %F-33 |");
+    LOGDEBUG("testing sensor.c with cache of size 2 and MAX_SENSOR_VALUES=%d\n", MAX_SENSOR_VALUES);
+
+    long long intervalMs = 50000;
+    assert(sensor_init(NULL, NULL, 2, FALSE, NULL) == 0);
+    assert(sensor_state->max_resources > 0);
+    assert(sensor_state->used_resources == 0);
+    assert(0 != sensor_config(-1, 5000));
+    assert(0 != sensor_config(MAX_SENSOR_VALUES + 1, 5000));
+    assert(0 != sensor_config(1, 50));
+    assert(0 != sensor_config(1, 50000000000));
+    assert(0 == sensor_config(0, 50000));
+    assert(0 == sensor_config(1, 50000));
+    assert(0 == sensor_config(3, intervalMs));
+
+#define GETSTAT_ITERS 10
+    // test the getstat function
+    getstat **stats = NULL;
+    for (int i = 1; i <= GETSTAT_ITERS; i++) {
+        if (i % 2) {
+            euca_this_component_name = "nc";
+        } else {
+            euca_this_component_name = "cc";
+        }
+        assert(getstat_generate(&stats) == EUCA_OK);
+        getstat *gs = getstat_find(stats, NULL);
+        if (gs != NULL) {
+            char id[1][MAX_SENSOR_NAME_LEN] = { "" };
+            char res[1][MAX_SENSOR_NAME_LEN] = { "" };
+            euca_strncpy(id[0], gs->instanceId, sizeof(id[0]));
+            assert(sensor_refresh_resources(id, res, 1) == EUCA_OK);
+        }
+        if (i % 101 == 0 || i % 102 == 0) {
+            LOGDEBUG("getstat_refresh() iteration %d/%d found %d instances\n", i, GETSTAT_ITERS, getstat_ninstances(stats));
+        }
+    }
+    char *anInstanceId = NULL;
+    if (stats) {
+        anInstanceId = stats[0]->instanceId;
+    }
+    if (anInstanceId != NULL)
+        assert(getstat_find(stats, anInstanceId) != NULL);
+
+    euca_this_component_name = "ignore";    // set component name so that getstats won't get involved and won't put real sensor readings into sensor state
+    getstat_free(stats);
+    init_state(2);                     // clear out sensor state after previous experiments
+    assert(0 == sensor_config(3, intervalMs));
+
+    // test sensor_add_value and sensor_get_value
+    double val = 11.0;
+    for (int j = 0; j < 50; j++) {
+        long long sn = -1L;
+        int valLen = 0;
+        for (int i = 0; i < ((MAX_SENSOR_VALUES / 2) * (j + 1)); i++) {
+            sn += 1;
+            ts += intervalMs;
+            val += 1;
+            assert(0 == sensor_add_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", sn, ts, (sn % 2) ? TRUE : FALSE, val));
+            assert(0 == sensor_add_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", sn, ts, (sn % 2) ? TRUE : FALSE, val));  // should be a no-op
+            valLen++;
+            if (valLen > MAX_SENSOR_VALUES)
+                valLen = MAX_SENSOR_VALUES;
+
+            {
+                long long last_sn;
+                long long last_ts;
+                boolean last_available;
+                double last_val;
+                long long last_intervalMs;
+                int last_valLen;
+
+                assert(0 == sensor_get_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
+                assert(last_sn == sn);
+                assert(last_ts == ts);
+                if (!(last_intervalMs == intervalMs)) {
+                    LOGERROR("bad\n");
+                }
+                assert(last_available == (sn % 2) ? TRUE : FALSE);
+                assert(last_val == val);
+                assert(last_valLen == valLen);
+            }
+        }
+        intervalMs += 50000;
+        assert(0 == sensor_config(3, intervalMs));
+    }
+
+    {                                  // the rollups outlast the values and are in order
+        sensorRollup rollups[SENSOR_ROLLUP_PERIODS];
+        int rollupsLen = 0;
+
+        for (int t = 0; t < SENSOR_ROLLUP_TIERS; t++) {
+            assert(0 == sensor_get_rollups("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", t, rollups, SENSOR_ROLLUP_PERIODS, &rollupsLen));
+            assert(rollupsLen == SENSOR_ROLLUP_PERIODS);
+            for (int i = 0; i < rollupsLen; i++) {
+                assert((rollups[i].startMs % sensor_rollup_period_ms[t]) == 0);
+                assert((i == 0) || (rollups[i].startMs > rollups[i - 1].startMs));
+                assert((rollups[i].count > 0) && (rollups[i].min <= rollups[i].max));
+                assert((rollups[i].sum >= (rollups[i].min * rollups[i].count)) && (rollups[i].sum <= (rollups[i].max * rollups[i].count)));
+            }
+            assert(rollups[rollupsLen - 1].startMs == (ts - (ts % sensor_rollup_period_ms[t])));   // the last value is available
+        }
+        assert(0 != sensor_get_rollups("i-555", "CPUUtilization", SENSOR_AVERAGE, "nosuch", 0, rollups, SENSOR_ROLLUP_PERIODS, &rollupsLen));
+        assert(0 != sensor_get_rollups("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", SENSOR_ROLLUP_TIERS, rollups, SENSOR_ROLLUP_PERIODS, &rollupsLen));
+    }
+
+    // add the "dummy" struct as a second resource
+    sensorResource **srs = EUCA_ZALLOC(sensor_state->max_resources, sizeof(sensorResource *));
+    assert(srs);
+    for (int i = 0; i < sensor_state->max_resources; i++) {
+        srs[i] = EUCA_ZALLOC(1, sizeof(sensorResource));
+        assert(srs[i]);
     }
     assert(0 == sensor_get_dummy_instance_data(0L, "i-666", NULL, 0, srs, sensor_state->max_resources));
     assert(0 == sensor_merge_records(srs, sensor_state->max_resources, TRUE));
@@ -2165,6 +4363,24 @@ int main(int argc, char **argv)
     assert(0 != sensor_add_value("i-666", "DiskReadOps", SENSOR_AVERAGE, "root", 0, 0, TRUE, 0));   // exceeding MAX_SENSOR_COUNTERS (1)
     assert(0 != sensor_add_value("i-666", "DiskReadOps", SENSOR_SUMMATION, "another", 0, 0, TRUE, 0));  // exceeding MAX_SENSOR_DIMENSIONS (3)
 
+    {                                  // lookups by alias go through the alias index and follow alias changes
+        long long last_sn;
+        long long last_ts;
+        boolean last_available;
+        double last_val;
+        long long last_intervalMs;
+        int last_valLen;
+
+        assert(0 == sensor_set_resource_alias("i-555", "10.0.0.5"));
+        assert(0 == sensor_get_value("10.0.0.5", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
+        assert(0 == sensor_set_resource_alias("i-555", "10.0.0.6"));
+        assert(0 != sensor_get_value("10.0.0.5", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
+        assert(0 == sensor_get_value("10.0.0.6", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
+        assert(0 == sensor_set_resource_alias("i-555", NULL));
+        assert(0 != sensor_get_value("10.0.0.6", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
+        assert(0 == sensor_get_value("i-555", "CPUUtilization", SENSOR_AVERAGE, "default", &last_sn, &last_ts, &last_available, &last_val, &last_intervalMs, &last_valLen));
+    }
+
     dump_sensor_cache();
 
     int srsLen = sensor_state->max_resources;
@@ -2185,6 +4401,65 @@ int main(int argc, char **argv)
     assert(0 == sensor_get_instance_data("i-555", NULL, 0, srs, srsLen));   // same
     log_sensor_resources("values read from cache", srs, srsLen);
 
+    {                                  // batches carry the values and the cursors leave out those that the cache has
+        char *batch = NULL;
+        char *cursors = NULL;
+        char *names[] = { "i-555" };
+        sensorResource **decoded = NULL;
+        int decodedLen = 0;
+
+        LOGDEBUG("testing sensor_encode_batch() and sensor_decode_batch() functions\n");
+        assert(0 == sensor_encode_batch(srs, 1, MAX_SENSOR_VALUES, NULL, &batch));
+        assert(0 == sensor_decode_batch(batch, &decoded, &decodedLen));
+        assert(decodedLen == 1);
+        assert(!strcmp(decoded[0]->resourceName, srs[0]->resourceName));
+        assert(decoded[0]->metricsLen == srs[0]->metricsLen);
+        for (int m = 0; m < srs[0]->metricsLen; m++) {
+            for (int c = 0; c < srs[0]->metrics[m].countersLen; c++) {
+                for (int d = 0; d < srs[0]->metrics[m].counters[c].dimensionsLen; d++) {
+                    const sensorDimension *sd = srs[0]->metrics[m].counters[c].dimensions + d;
+                    const sensorDimension *dd = decoded[0]->metrics[m].counters[c].dimensions + d;
+                    assert(dd->sequenceNum == sd->sequenceNum);
+                    assert(dd->valuesLen == sd->valuesLen);
+                    for (int v = 0; v < sd->valuesLen; v++) {
+                        const sensorValue *sv = sd->values + ((sd->firstValueIndex + v) % MAX_SENSOR_VALUES);
+                        assert(dd->values[v].timestampMs == sv->timestampMs);
+                        assert(dd->values[v].available == sv->available);
+                        assert(!sv->available || (dd->values[v].value == (sv->value + sd->shift_value)));
+                    }
+                }
+            }
+        }
+        assert(0 == sensor_merge_records(decoded, decodedLen, TRUE));
+        for (int i = 0; i < decodedLen; i++) {
+            EUCA_FREE(decoded[i]);
+        }
+        EUCA_FREE(decoded);
+        EUCA_FREE(batch);
+
+        assert(0 == sensor_get_cursors(names, 1, &cursors));
+        assert(0 == sensor_encode_batch(srs, 1, MAX_SENSOR_VALUES, cursors, &batch));
+        assert(0 == sensor_decode_batch(batch, &decoded, &decodedLen));
+        assert(decodedLen == 1);
+        for (int m = 0; m < decoded[0]->metricsLen; m++) {
+            for (int c = 0; c < decoded[0]->metrics[m].countersLen; c++) {
+                for (int d = 0; d < decoded[0]->metrics[m].counters[c].dimensionsLen; d++) {
+                    assert(decoded[0]->metrics[m].counters[c].dimensions[d].valuesLen == 0);
+                }
+            }
+        }
+        for (int i = 0; i < decodedLen; i++) {
+            EUCA_FREE(decoded[i]);
+        }
+        EUCA_FREE(decoded);
+        EUCA_FREE(batch);
+        EUCA_FREE(cursors);
+
+        assert(0 != sensor_decode_batch("SB1 1 1\ni-555\nR 0 0 3 1\n", &decoded, &decodedLen));
+        assert(0 != sensor_decode_batch("SB2 0 0\n", &decoded, &decodedLen));
+        assert((decoded == NULL) && (decodedLen == 0));
+    }
+
     for (int i = 0; i < sensor_state->max_resources; i++) {
         EUCA_FREE(srs[i]);
     }
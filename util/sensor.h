@@ -78,6 +78,7 @@
 \*----------------------------------------------------------------------------*/
 
 #include "ipc.h"
+#include "euca_alloc.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -85,19 +86,28 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
+#if !defined(_UNIT_TEST) || defined(_BENCHMARK)
+//! The benchmark needs the production sizes, but may be built with another MAX_SENSOR_VALUES to size the history
 #define MAX_SENSOR_NAME_LEN                      64
+#ifndef MAX_SENSOR_VALUES
 #define MAX_SENSOR_VALUES                        15 //!< by default 10 on CLC
+#endif /* ! MAX_SENSOR_VALUES */
 #define MAX_SENSOR_DIMENSIONS                    (5 + EUCA_MAX_VOLUMES) //!< root, ephemeral[0-1], vol-XYZ
 #define MAX_SENSOR_COUNTERS                      2  //!< we only have two types of counters in use (summation|latest) for now
 #define MAX_SENSOR_METRICS                       12 //!< currently 12 are implemented
-#else /* ! _UNIT_TEST */
+#define SENSOR_RESOURCE_SLAB_MAX_FREE            64 //!< most freed resource records kept for the next batch
+#define SENSOR_ROLLUP_PERIODS                    12 //!< periods kept per rollup tier, an hour of 5-minute rollups
+#define SENSOR_ROLLUP_SERIES                     32 //!< dimensions of a resource that get rollups
+#else /* ! _UNIT_TEST || _BENCHMARK */
 #define MAX_SENSOR_NAME_LEN                      64
 #define MAX_SENSOR_VALUES                         5 // smaller sizes, for easier testing of limits
 #define MAX_SENSOR_DIMENSIONS                     3
 #define MAX_SENSOR_COUNTERS                       1
 #define MAX_SENSOR_METRICS                        2
-#endif /* ! _UNIT_TEST */
+#define SENSOR_RESOURCE_SLAB_MAX_FREE             4
+#define SENSOR_ROLLUP_PERIODS                     3
+#define SENSOR_ROLLUP_SERIES                      4
+#endif /* ! _UNIT_TEST || _BENCHMARK */
 
 #define DEFAULT_SENSOR_SLEEP_DURATION_USEC       15000000L
 #define MIN_COLLECTION_INTERVAL_MS                   1000L  //!< below 1 second is too frequent
@@ -108,6 +118,9 @@
 //! upstream polling interval will be expired from the cache.
 #define CACHE_EXPIRY_MULTIPLE_OF_POLLING_INTERVAL 3
 
+#define SENSOR_INDEX_SIZE                        (2 * MAXINSTANCES_PER_CC)  //!< buckets per resource lookup index, power of 2
+#define SENSOR_READ_RETRIES                      10 //!< lock-free read attempts before falling back to the semaphore
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -128,6 +141,20 @@ typedef enum {
     SENSOR_LATEST
 } sensorCounterType;
 
+//! Rollup tiers of the sensor resource cache, see sensor_get_rollups()
+enum {
+    SENSOR_ROLLUP_1MIN,
+    SENSOR_ROLLUP_5MIN,
+    SENSOR_ROLLUP_TIERS,
+};
+
+//! Resource lookup indexes of the sensor resource cache
+enum {
+    SENSORIDX_NAME,
+    SENSORIDX_ALIAS,
+    SENSORIDX_LAST,
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
@@ -150,6 +177,7 @@ typedef struct {
     int valuesLen;                     //!< size of the array
     int firstValueIndex;               //!< index into values[] of the first value (one that matches sequenceNum)
     double shift_value;                // amount that should be added to all values at this dimension
+    int rollupSeries;                  //!< (index + 1) of the rollups of this dimension among those of its resource, 0 if none
 } sensorDimension;
 
 //! Sensor counter structure
@@ -176,8 +204,27 @@ typedef struct {
     sensorMetric metrics[MAX_SENSOR_METRICS];   //!< array of values (not pointers, to simplify shared-memory region use)
     int metricsLen;                    //!< size of the array
     int timestamp;                     // timestamp for last receipt of metrics
+    volatile unsigned int seq;         //!< even when stable, odd while the writer is updating this resource
+    int rollupSeriesLen;               //!< number of the rollup series of this resource in use
 } sensorResource;
 
+//! Aggregate of the values of a dimension over one period of a rollup tier
+typedef struct {
+    long long startMs;                 //!< start of the period, a multiple of its length
+    double min;
+    double max;
+    double sum;
+    int count;                         //!< number of available values aggregated
+} sensorRollup;
+
+//! Rollups of a dimension, one ring of the latest periods per tier
+typedef struct {
+    long long lastMs;                  //!< timestamp of the latest value aggregated, values up to it are not counted again
+    sensorRollup rollups[SENSOR_ROLLUP_TIERS][SENSOR_ROLLUP_PERIODS];
+    int rollupsLen[SENSOR_ROLLUP_TIERS];   //!< number of periods in each ring
+    int firstRollupIndex[SENSOR_ROLLUP_TIERS];  //!< index into rollups[] of the oldest period of each ring
+} sensorRollupSeries;
+
 //! Sensor resource cache structure
 typedef struct {
     long long collection_interval_time_ms;
@@ -188,9 +235,30 @@ typedef struct {
     int used_resources;
     time_t last_polled;
     time_t interval_polled;
+    volatile unsigned int index_seq;   //!< even when stable, odd while the lookup indexes are being changed
+    int index[SENSORIDX_LAST][SENSOR_INDEX_SIZE];   //!< open addressing hash indexes by name and alias, entries are (slot + 1) and 0 when free
     sensorResource resources[1];       //!< if struct should be allocated with extra space after it for additional cache elements
 } sensorResourceCache;
 
+//! Bytes of a sensor resource cache of a number of resources. The rollup series of the
+//! resources follow the resources, SENSOR_ROLLUP_SERIES of them per resource.
+#define SENSOR_CACHE_SIZE(_resources)            (sizeof(sensorResourceCache) + (sizeof(sensorResource) * ((_resources) - 1)) \
+                                                  + (sizeof(sensorRollupSeries) * SENSOR_ROLLUP_SERIES * (_resources)))
+
+//! Temporary storage of polled stats, one linked list per instance
+typedef struct getstat_t {
+    char instanceId[100];
+    long long timestamp;
+    char metricName[100];
+    int counterType;
+    char dimensionName[100];
+    double value;
+    struct getstat_t *next;
+} getstat;
+
+//! Native stats collector, fills in the NULL-terminated array of per-instance lists
+typedef int (*sensorStatsCollector) (getstat *** pstats);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -200,6 +268,9 @@ typedef struct {
 //! Sensor counter type names matching the enum
 extern const char *sensorCounterTypeName[];
 
+//! Slab of the resource records of sensor_decode_batch(), to be freed with EUCA_SLAB_FREE()
+extern euca_slab sensor_resource_slab;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED PROTOTYPES                            |
@@ -211,6 +282,8 @@ int sensor_suspend_polling(void);
 int sensor_resume_polling(void);
 int sensor_config(int new_history_size, long long new_collection_interval_time_ms);
 int sensor_set_hyp_sem(sem * sem);
+int sensor_set_stats_collector(sensorStatsCollector collector);
+int getstat_append(getstat *** pstats, const char *instanceId, long long timestamp, const char *metricName, int counterType, const char *dimensionName, double value);
 int sensor_get_config(int *history_size, long long *collection_interval_time_ms);
 int sensor_get_num_resources(void);
 sensorCounterType sensor_str2type(const char *counterType);
@@ -223,6 +296,8 @@ int sensor_add_value(const char *instanceId, const char *metricName, const int c
 int sensor_get_value(const char *instanceId, const char *metricName, const int counterType, const char *dimensionName, long long *sequenceNum,
                      long long *timestampMs, boolean * available, double *value, long long *intervalMs, int *valLen);
 int sensor_get_instance_data(const char *instanceId, char **sensorIds, int sensorIdsLen, sensorResource ** sr_out, int srLen);
+int sensor_get_rollups(const char *resourceName, const char *metricName, const int counterType, const char *dimensionName, const int tier, sensorRollup * rollups,
+                       int rollupsSize, int *rollupsLen);
 int sensor_add_resource(const char *resourceName, const char *resourceType, const char *resourceUuid);
 int sensor_set_resource_alias(const char *resourceName, const char *resourceAlias);
 int sensor_remove_resource(const char *resourceName);
@@ -231,6 +306,9 @@ int sensor_set_dimension_alias(const char *resourceName, const char *metricName,
 int sensor_set_volume(const char *instanceId, const char *volumeId, const char *guestDev);
 int sensor_refresh_resources(char resourceNames[][MAX_SENSOR_NAME_LEN], char resourceAliases[][MAX_SENSOR_NAME_LEN], int size);
 int sensor_validate_resources(sensorResource ** srs, int srsLen);
+int sensor_get_cursors(char **resourceNames, int resourceNamesLen, char **cursors);
+int sensor_encode_batch(sensorResource ** srs, int srsLen, int historySize, const char *cursors, char **batch);
+int sensor_decode_batch(const char *batch, sensorResource *** srs, int *srsLen);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
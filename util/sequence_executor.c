@@ -65,7 +65,11 @@
 
 //!
 //! @file util/sequence_executor.c
-//! This file needs a description
+//! Runs a list of shell commands, with cleanup commands run in reverse order on failure. By
+//! default the commands run one after the other. After se_set_parallel(), they run as a
+//! dependency graph: a command starts once those declared with se_depend() as its
+//! prerequisites have succeeded. Commands that do not depend on each other run at the same
+//! time.
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -77,6 +81,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <misc.h>
 
@@ -100,12 +105,31 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! State of a command during a parallel se_execute()
+typedef enum se_state_t {
+    SE_PENDING = 0,                    //!< not started yet
+    SE_RUNNING,                        //!< running
+    SE_SUCCEEDED,                      //!< ran and succeeded
+    SE_FAILED,                         //!< ran and failed
+    SE_SKIPPED,                        //!< not run, because a prerequisite did not succeed
+} se_state;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! What the workers of a parallel se_execute() share
+typedef struct se_run_t {
+    sequence_executor *se;             //!< the commands
+    se_state states[MAX_SE_COMMANDS];  //!< the state of each command
+    int pending;                       //!< number of commands in SE_PENDING
+    int failed;                        //!< set when a command failed
+    pthread_mutex_t mutex;             //!< guards the above
+    pthread_cond_t cond;               //!< signaled whenever a command completes
+} se_run;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -132,6 +156,11 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int se_run_command(sequence_executor * se, int i);
+static int se_next_command(se_run * run);
+static void *se_worker(void *arg);
+static int se_execute_parallel(sequence_executor * se);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -243,6 +272,54 @@ int se_add(sequence_executor * se, char *command, char *cleanup_command, void *c
     return (0);
 }
 
+//!
+//! Switches the executor to parallel mode, in which commands run as soon as their
+//! prerequisites (see se_depend()) have succeeded, up to max_parallel at a time. A command
+//! without prerequisites may run at any time. When a command fails, those that depend on it,
+//! directly or not, are skipped; the others still run.
+//!
+//! @param[in] se
+//! @param[in] max_parallel how many commands may run at once, at most MAX_SE_PARALLEL; 0 or 1 goes back to running them in order
+//!
+//! @return 0 on success or 1 on failure
+//!
+int se_set_parallel(sequence_executor * se, int max_parallel)
+{
+    if (!se || !se->init || (max_parallel < 0)) {
+        return (1);
+    }
+
+    se->max_parallel = ((max_parallel > MAX_SE_PARALLEL) ? MAX_SE_PARALLEL : max_parallel);
+    return (0);
+}
+
+//!
+//! Declares that a command must not run before another one has succeeded. Commands are
+//! numbered from 0 in the order they were se_add()ed, and a command may only depend on
+//! commands added before it, which keeps the graph free of cycles.
+//!
+//! @param[in] se
+//! @param[in] step the command that waits
+//! @param[in] prerequisite the command it waits for
+//!
+//! @return 0 on success or 1 on failure
+//!
+int se_depend(sequence_executor * se, int step, int prerequisite)
+{
+    int *prerequisites = NULL;
+
+    if (!se || !se->init || (step >= se->max_commands) || (prerequisite < 0) || (prerequisite >= step)) {
+        return (1);
+    }
+
+    if ((prerequisites = EUCA_REALLOC(se->prerequisites[step], (se->max_prerequisites[step] + 1), sizeof(int))) == NULL) {
+        return (1);
+    }
+    prerequisites[se->max_prerequisites[step]++] = prerequisite;
+    se->prerequisites[step] = prerequisites;
+    return (0);
+}
+
 //!
 //! Function description.
 //!
@@ -273,19 +350,176 @@ int se_print(sequence_executor * se)
 }
 
 //!
-//! Function description.
+//! Runs one command, with its timeout and exit checker
 //!
 //! @param[in] se
+//! @param[in] i the command
 //!
-//! @return
+//! @return 0 if the command succeeded or its exit code, as seen by its checker, otherwise
 //!
-//! @see
+static int se_run_command(sequence_executor * se, int i)
+{
+    int rc = 0;
+    char out[1024] = "";
+    char err[1024] = "";
+
+    LOGDEBUG("RUNNING COMMAND: command='%s'\n", se->commands[i]);
+    rc = timeshell(se->commands[i], out, err, 1024, se->commands_timers[i] ? se->commands_timers[i] : se->default_timeout);
+
+    if (se->checkers[i]) {
+        rc = se->checkers[i] (rc, out, err);
+    }
+
+    if (rc) {
+        LOGERROR("COMMAND FAILED: exitcode='%d' command='%s' stdout='%s' stderr='%s'\n", rc, se->commands[i], out, err);
+    } else {
+        LOGDEBUG("COMMAND SUCCESS: command='%s' stdout='%s' stderr='%s'\n", se->commands[i], out, err);
+    }
+    return (rc);
+}
+
 //!
-//! @pre List of pre-conditions
+//! Finds a command that can start. Commands whose prerequisites did not all succeed are
+//! marked skipped along the way. Must be called with the lock of the run held.
 //!
-//! @post List of post conditions
+//! @param[in] run
 //!
-//! @note
+//! @return the command, or -1 if none can start now
+//!
+static int se_next_command(se_run * run)
+{
+    int i = 0;
+    int j = 0;
+    int waiting = 0;
+    int blocked = 0;
+    sequence_executor *se = run->se;
+
+    for (i = 0; (i < se->max_commands) && (run->pending > 0); i++) {
+        if (run->states[i] != SE_PENDING)
+            continue;
+
+        for (j = 0, waiting = 0, blocked = 0; j < se->max_prerequisites[i]; j++) {
+            switch (run->states[se->prerequisites[i][j]]) {
+            case SE_SUCCEEDED:
+                break;
+            case SE_FAILED:
+            case SE_SKIPPED:
+                blocked = 1;
+                break;
+            default:
+                waiting = 1;
+                break;
+            }
+        }
+
+        if (blocked) {
+            LOGDEBUG("SKIPPING COMMAND: a prerequisite did not succeed: command='%s'\n", se->commands[i]);
+            run->states[i] = SE_SKIPPED;
+            run->pending--;
+        } else if (!waiting) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+//!
+//! Runs commands as they become ready, until none is left to start
+//!
+//! @param[in] arg the run
+//!
+//! @return NULL
+//!
+static void *se_worker(void *arg)
+{
+    int i = 0;
+    int rc = 0;
+    se_run *run = arg;
+
+    pthread_mutex_lock(&run->mutex);
+    while (run->pending > 0) {
+        if ((i = se_next_command(run)) < 0) {
+            // the remaining commands wait for running ones
+            if (run->pending > 0)
+                pthread_cond_wait(&run->cond, &run->mutex);
+            continue;
+        }
+
+        run->states[i] = SE_RUNNING;
+        run->pending--;
+        pthread_mutex_unlock(&run->mutex);
+
+        rc = se_run_command(run->se, i);
+
+        pthread_mutex_lock(&run->mutex);
+        run->states[i] = (rc ? SE_FAILED : SE_SUCCEEDED);
+        if (rc)
+            run->failed = 1;
+        pthread_cond_broadcast(&run->cond);
+    }
+    pthread_mutex_unlock(&run->mutex);
+    return (NULL);
+}
+
+//!
+//! The parallel mode of se_execute(). The calling thread is one of the workers.
+//!
+//! @param[in] se
+//!
+//! @return 0 if all commands succeeded or 1 otherwise
+//!
+static int se_execute_parallel(sequence_executor * se)
+{
+    int i = 0;
+    int nthreads = 0;
+    int workers = ((se->max_parallel < se->max_commands) ? se->max_parallel : se->max_commands);
+    pthread_t threads[MAX_SE_PARALLEL] = { 0 };
+    se_run *run = NULL;
+
+    if ((run = EUCA_ZALLOC(1, sizeof(se_run))) == NULL) {
+        return (1);
+    }
+    run->se = se;
+    run->pending = se->max_commands;
+    pthread_mutex_init(&run->mutex, NULL);
+    pthread_cond_init(&run->cond, NULL);
+
+    for (nthreads = 0; nthreads < (workers - 1); nthreads++) {
+        if (pthread_create(&threads[nthreads], NULL, se_worker, run) != 0) {
+            LOGWARN("could not start a command thread, running with %d\n", (nthreads + 1));
+            break;
+        }
+    }
+    se_worker(run);
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // the cleanups of the commands that ran, in reverse order, which respects the dependencies
+    if (se->clean_only_on_fail && run->failed) {
+        for (i = (se->max_commands - 1); i >= 0; i--) {
+            if (se->cleanup_commands[i] && ((run->states[i] == SE_SUCCEEDED) || (run->states[i] == SE_FAILED))) {
+                LOGDEBUG("RUNNING CLEANUP_COMMAND: command='%s'\n", se->cleanup_commands[i]);
+                euca_run_shell(se->cleanup_commands[i], 0, se->default_timeout, NULL, NULL, NULL);
+            }
+        }
+    }
+
+    i = run->failed;
+    pthread_cond_destroy(&run->cond);
+    pthread_mutex_destroy(&run->mutex);
+    EUCA_FREE(run);
+    return (i ? 1 : 0);
+}
+
+//!
+//! Runs the commands, in order or, after se_set_parallel(), concurrently as their
+//! prerequisites allow. On failure, and if the executor was set up to clean only on failure,
+//! the cleanup commands of the commands that ran are run in reverse order.
+//!
+//! @param[in] se
+//!
+//! @return 0 if all commands succeeded or 1 otherwise
 //!
 int se_execute(sequence_executor * se)
 {
@@ -294,31 +528,25 @@ int se_execute(sequence_executor * se)
     int failed = 0;
     int lastran = 0;
     int ret = 0;
-    char out[1024] = "";
-    char err[1024] = "";
 
     if (!se || !se->init) {
         return (1);
     }
 
+    if ((se->max_parallel > 1) && (se->max_commands > 1)) {
+        return (se_execute_parallel(se));
+    }
+
     ret = 0;
     failed = 0;
 
     for (i = 0; i < se->max_commands; i++) {
-        LOGDEBUG("RUNNING COMMAND: command='%s'\n", se->commands[i]);
-        rc = timeshell(se->commands[i], out, err, 1024, se->commands_timers[i] ? se->commands_timers[i] : se->default_timeout);
+        rc = se_run_command(se, i);
         lastran = i;
 
-        if (se->checkers[i]) {
-            rc = se->checkers[i] (rc, out, err);
-        }
-
         if (rc) {
-            LOGERROR("COMMAND FAILED: exitcode='%d' command='%s' stdout='%s' stderr='%s'\n", rc, se->commands[i], out, err);
             failed = 1;
             break;
-        } else {
-            LOGDEBUG("COMMAND SUCCESS: command='%s' stdout='%s' stderr='%s'\n", se->commands[i], out, err);
         }
     }
 
@@ -326,8 +554,7 @@ int se_execute(sequence_executor * se)
         for (i = lastran; i >= 0; i--) {
             if (se->cleanup_commands[i]) {
                 LOGDEBUG("RUNNING CLEANUP_COMMAND: command='%s'\n", se->cleanup_commands[i]);
-                rc = system(se->cleanup_commands[i]);
-                rc = rc >> 8;
+                rc = euca_run_shell(se->cleanup_commands[i], 0, se->default_timeout, NULL, NULL, NULL);
             }
         }
     }
@@ -356,6 +583,8 @@ int se_execute(sequence_executor * se)
 int se_free(sequence_executor * se)
 {
     int i = 0;
+    int rc = 0;
+    int max_parallel = 0;
 
     if (!se || !se->init) {
         return (1);
@@ -367,8 +596,14 @@ int se_free(sequence_executor * se)
 
         if (se->cleanup_commands[i])
             free(se->cleanup_commands[i]);
+
+        EUCA_FREE(se->prerequisites[i]);
     }
-    return (se_init(se, se->cmdprefix, se->default_timeout, se->clean_only_on_fail));
+
+    max_parallel = se->max_parallel;
+    rc = se_init(se, se->cmdprefix, se->default_timeout, se->clean_only_on_fail);
+    se->max_parallel = max_parallel;
+    return (rc);
 }
 
 //!
@@ -84,6 +84,7 @@
 \*----------------------------------------------------------------------------*/
 
 #define MAX_SE_COMMANDS                          1024
+#define MAX_SE_PARALLEL                            16   //!< most commands se_execute() runs at once
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -114,9 +115,13 @@ typedef struct sequence_executor_t {
 
     func_ptr checkers[MAX_SE_COMMANDS];
 
+    int *prerequisites[MAX_SE_COMMANDS];    //!< for each command, the commands that must succeed before it runs (parallel mode)
+    int max_prerequisites[MAX_SE_COMMANDS]; //!< for each command, the number of entries in prerequisites
+
     int max_commands, init, clean_only_on_fail;
     char cmdprefix[EUCA_MAX_PATH];
     int default_timeout;
+    int max_parallel;                  //!< how many commands may run at once; 0 or 1 runs them in order
 } sequence_executor;
 
 /*----------------------------------------------------------------------------*\
@@ -135,6 +140,8 @@ typedef struct sequence_executor_t {
 //! @name interface functions
 int se_init(sequence_executor * se, char *cmdprefix, int default_timeout, int clean_only_on_fail);
 int se_add(sequence_executor * se, char *command, char *cleanup_command, void *checker);
+int se_set_parallel(sequence_executor * se, int max_parallel);
+int se_depend(sequence_executor * se, int step, int prerequisite);
 int se_print(sequence_executor * se);
 int se_execute(sequence_executor * se);
 int se_free(sequence_executor * se);
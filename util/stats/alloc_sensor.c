@@ -0,0 +1,290 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/alloc_sensor.c
+//! Allocation sensor, reporting the call site counters and slabs of util/euca_alloc.c.
+//! They only count in components built with EUCA_ALLOC_TRACKING.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "alloc_sensor.h"
+#include "sensor_common.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <eucalyptus.h>
+#include <euca_string.h>
+#include <euca_alloc.h>
+#include <string.h>
+#include <log.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static int alloc_sensor_ttl = 0;
+static char interval_tag[SENSOR_TAG_MAX];
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static json_object *alloc_sensor_values_call();
+
+#ifdef _UNIT_TEST
+static int test_alloc_sensor();
+
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Gets the statistics of the busiest call sites, keyed by file:line, and of
+//! the slabs, keyed by the name of their structure.
+static json_object *alloc_sensor_values_call() {
+    int sites_len = 0;
+    int slabs_len = 0;
+    euca_alloc_site_stats *sites = NULL;
+    euca_slab_stats *slabs = NULL;
+    json_object *alloc_data;
+    json_object *sites_data;
+    json_object *slabs_data;
+    json_object *entry;
+
+    if ((euca_alloc_stats_get(&sites, &sites_len, ALLOC_SENSOR_MAX_SITES) != EUCA_OK) || (euca_slab_stats_get(&slabs, &slabs_len) != EUCA_OK)) {
+        LOGERROR("Failed to get allocation statistics\n");
+        free(sites);
+        return NULL;
+    }
+
+    sites_data = json_object_new_object();
+    for (int i = 0; i < sites_len; i++) {
+        entry = json_object_new_object();
+        json_object_object_add(entry, "kind", json_object_new_string(sites[i].kind));
+        json_object_object_add(entry, "calls", json_object_new_int64(sites[i].calls));
+        json_object_object_add(entry, "bytes", json_object_new_int64(sites[i].bytes));
+        json_object_object_add(sites_data, sites[i].site, entry);
+    }
+
+    slabs_data = json_object_new_object();
+    for (int i = 0; i < slabs_len; i++) {
+        entry = json_object_new_object();
+        json_object_object_add(entry, "size", json_object_new_int64(slabs[i].size));
+        json_object_object_add(entry, "allocs", json_object_new_int64(slabs[i].allocs));
+        json_object_object_add(entry, "reuses", json_object_new_int64(slabs[i].reuses));
+        json_object_object_add(entry, "frees", json_object_new_int64(slabs[i].frees));
+        json_object_object_add(entry, "free_count", json_object_new_int(slabs[i].free_count));
+        json_object_object_add(slabs_data, slabs[i].name, entry);
+    }
+
+    // the arrays come from euca_alloc.c, which does not count its own allocations
+    free(sites);
+    free(slabs);
+
+    alloc_data = json_object_new_object();
+    json_object_object_add(alloc_data, "sites", sites_data);
+    json_object_object_add(alloc_data, "slabs", slabs_data);
+    return alloc_data;
+}
+
+//! Entry point for the allocation sensor
+json_object *alloc_sensor_call() {
+    json_object *alloc_data;
+    json_object *event_json;
+    json_object *tags;
+
+    if ((alloc_data = alloc_sensor_values_call()) == NULL) {
+        return NULL;
+    }
+
+    tags = build_tag_set(1, interval_tag);
+    //The output gets its own copy of the values
+    event_json = build_sensor_output(alloc_sensor.sensor_name, ALLOC_SENSOR_DESCRIPTION, time(NULL), alloc_sensor_ttl, tags, alloc_data);
+    json_object_put(alloc_data);
+
+    if(event_json == NULL) {
+        LOGERROR("Failed in allocation stats output generation.");
+        return NULL;
+    }
+
+    return event_json;
+}
+
+//! Idempotently initialize the allocation sensor structures. Not threadsafe.
+int initialize_alloc_sensor(const char *service_name, int interval, int event_ttl) {
+    if(service_name == NULL || event_ttl < 0) {
+        LOGERROR("Invalid initialization values for allocation sensor. Cannot initialize\n");
+        return EUCA_ERROR;
+    }
+
+    LOGINFO("Initializing allocation sensor for component %s\n", service_name);
+    euca_strncpy(alloc_sensor.config_name, ALLOC_SENSOR_NAME, SENSOR_NAME_MAX);
+    snprintf(alloc_sensor.sensor_name, SENSOR_NAME_MAX, ALLOC_SENSOR_NAME_FORMAT, service_name);
+    alloc_sensor.enabled = 0;
+    alloc_sensor.sensor_function = alloc_sensor_call;
+    alloc_sensor.state_toggle_callback = NULL;
+    alloc_sensor.values_function = alloc_sensor_values_call;
+
+    alloc_sensor_ttl = event_ttl;
+    snprintf(interval_tag, SENSOR_TAG_MAX, SENSOR_INTERVAL_PERIOD_TAG_FORMAT, interval);
+
+    return EUCA_OK;
+}
+
+#ifdef _UNIT_TEST
+
+int test_alloc_sensor() {
+    int test_ttl = 60;
+    static euca_alloc_site test_site = EUCA_ALLOC_SITE_INITIALIZER("alloc");
+    static euca_slab test_slab = EUCA_SLAB_INITIALIZER("test_struct", char[128], 2);
+    json_object *event = NULL;
+    void *ptr = NULL;
+
+    initialize_alloc_sensor("nc", test_ttl, test_ttl);
+    for (int i = 0; i < 10; i++) {
+        free(euca_alloc_at(&test_site, i + 1, 16, 0));
+        ptr = euca_slab_alloc(&test_slab, 1);
+        euca_slab_free(&test_slab, ptr);
+    }
+    if ((event = alloc_sensor_call()) == NULL) {
+        return 1;
+    }
+    LOGINFO("Result map: %s\n", json_object_to_json_string_ext(event, JSON_C_TO_STRING_PRETTY));
+    json_object_put(event);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if(test_alloc_sensor() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return 0;
+}
+#endif
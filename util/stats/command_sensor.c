@@ -0,0 +1,268 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/command_sensor.c
+//! Helper command sensor, reporting the latency counters that euca_run() and friends keep
+//! for every program they run.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "command_sensor.h"
+#include "sensor_common.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <eucalyptus.h>
+#include <euca_string.h>
+#include <misc.h>
+#include <string.h>
+#include <log.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static int command_sensor_ttl = 0;
+static char interval_tag[SENSOR_TAG_MAX];
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static json_object *command_sensor_values_call();
+
+#ifdef _UNIT_TEST
+static int test_command_sensor();
+
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Gets the counters of every command run so far, keyed by the program
+//! that did the work (e.g., losetup for "euca_rootwrap losetup").
+static json_object *command_sensor_values_call() {
+    int stats_len = 0;
+    euca_run_stats *stats = NULL;
+    json_object *command_data;
+    json_object *entry;
+
+    if (euca_run_stats_get(&stats, &stats_len) != EUCA_OK) {
+        LOGERROR("Failed to get helper command statistics\n");
+        return NULL;
+    }
+
+    command_data = json_object_new_object();
+    for (int i = 0; i < stats_len; i++) {
+        entry = json_object_new_object();
+        json_object_object_add(entry, "calls", json_object_new_int64(stats[i].calls));
+        json_object_object_add(entry, "failures", json_object_new_int64(stats[i].failures));
+        json_object_object_add(entry, "timeouts", json_object_new_int64(stats[i].timeouts));
+        json_object_object_add(entry, "total_usec", json_object_new_int64(stats[i].total_usec));
+        json_object_object_add(entry, "max_usec", json_object_new_int64(stats[i].max_usec));
+        json_object_object_add(entry, "avg_usec", json_object_new_int64((stats[i].calls > 0) ? (stats[i].total_usec / stats[i].calls) : 0));
+        json_object_object_add(command_data, stats[i].name, entry);
+    }
+    EUCA_FREE(stats);
+
+    return command_data;
+}
+
+//! Entry point for the helper command sensor
+json_object *command_sensor_call() {
+    json_object *command_data;
+    json_object *event_json;
+    json_object *tags;
+
+    if ((command_data = command_sensor_values_call()) == NULL) {
+        return NULL;
+    }
+
+    tags = build_tag_set(1, interval_tag);
+    //The output gets its own copy of the values
+    event_json = build_sensor_output(command_sensor.sensor_name, COMMAND_SENSOR_DESCRIPTION, time(NULL), command_sensor_ttl, tags, command_data);
+    json_object_put(command_data);
+
+    if(event_json == NULL) {
+        LOGERROR("Failed in helper command stats output generation.");
+        return NULL;
+    }
+
+    return event_json;
+}
+
+//! Idempotently initialize the helper command sensor structures. Not threadsafe.
+int initialize_command_sensor(const char *service_name, int interval, int event_ttl) {
+    if(service_name == NULL || event_ttl < 0) {
+        LOGERROR("Invalid initialization values for helper command sensor. Cannot initialize\n");
+        return EUCA_ERROR;
+    }
+
+    LOGINFO("Initializing helper command sensor for component %s\n", service_name);
+    euca_strncpy(command_sensor.config_name, COMMAND_SENSOR_NAME, SENSOR_NAME_MAX);
+    snprintf(command_sensor.sensor_name, SENSOR_NAME_MAX, COMMAND_SENSOR_NAME_FORMAT, service_name);
+    command_sensor.enabled = 0;
+    command_sensor.sensor_function = command_sensor_call;
+    command_sensor.state_toggle_callback = NULL;
+    command_sensor.values_function = command_sensor_values_call;
+
+    command_sensor_ttl = event_ttl;
+    snprintf(interval_tag, SENSOR_TAG_MAX, SENSOR_INTERVAL_PERIOD_TAG_FORMAT, interval);
+
+    return EUCA_OK;
+}
+
+#ifdef _UNIT_TEST
+
+int test_command_sensor() {
+    int test_ttl = 60;
+    int status = 0;
+    char *argv[] = { "true", NULL };
+    json_object *event = NULL;
+
+    initialize_command_sensor("nc", test_ttl, test_ttl);
+    for (int i = 0; i < 3; i++) {
+        euca_run(argv, NULL, 0, 0, NULL, NULL, &status);
+    }
+    if ((event = command_sensor_call()) == NULL) {
+        return 1;
+    }
+    LOGINFO("Result map: %s\n", json_object_to_json_string_ext(event, JSON_C_TO_STRING_PRETTY));
+    json_object_put(event);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if(test_command_sensor() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return 0;
+}
+#endif
@@ -68,6 +68,12 @@
 //! Implementation of event emitter the writes json to the filesystem with
 //!  each sensor event in a unique file identified by the sensor name
 //!
+//! In the segments mode (STATS_EMITTER_MODE="segments"), the events of a
+//!  sensor pass are instead appended as json lines to the newest segment file
+//!  with a single write and sync (group commit) when the pass is over, which
+//!  emitter_flush() does. Consumers read the events in order from an offset
+//!  they keep with emitter_load_offset()/emitter_store_offset().
+//!
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -80,9 +86,15 @@
 #include <eucalyptus.h>
 #include <euca_file.h>
 #include <euca_string.h>
+#include <config.h>
+#include <misc.h>
 #include <diskutil.h>
 #include <log.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <json/json.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -139,6 +151,19 @@ static struct group *euca_stats_group;
 const static int file_flags = O_CREAT | O_WRONLY;
 static char euca_stats_path[EUCA_MAX_PATH];
 
+//! @{
+//! @name state of the segments mode, only used from the thread running the sensor passes
+static int segments_enabled = FALSE;
+static int segment_chown = TRUE;    //!< whether new segments are given to DATA_OUTPUT_USER and DATA_OUTPUT_GROUP
+static char segment_dir[EUCA_MAX_PATH];
+static long long segment_max_bytes = SEGMENT_MAX_BYTES;
+static int segment_fd = -1;         //!< newest segment, opened with the first flush
+static long long segment_size = 0;
+static char *pending_events = NULL; //!< events not yet written, one json document per line
+static size_t pending_len = 0;
+static size_t pending_size = 0;
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -152,6 +177,15 @@ static char *expand_data_path(const char *path);
 static int set_stats_output_path(const char *euca_home);
 static char *get_stats_output_path();
 static void euca_chrreplace(char *haystack, char target, char replacement);
+static int init_segments(const char *dir, int chown);
+static int append_event(json_object *event);
+static int list_segments(const char *dir, long long **numbers, int *count);
+static int compare_segments(const void *a, const void *b);
+static void get_segment_path(const char *dir, long long number, char *path, size_t len);
+static int open_next_segment();
+static void close_segment();
+static int write_all(int fd, const char *buf, size_t len);
+static int get_offset_path(const char *dir, const char *consumer, char *path, size_t len);
 
 #ifdef _UNIT_TEST
 static char *test_home; //home dir for tests
@@ -160,6 +194,7 @@ static int test_get_temp_output_name();
 static int test_get_output_name();
 static int test_write_event_to_file();
 static int test_get_set_stats_path();
+static int test_segments();
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -204,12 +239,28 @@ int init_emitter(const char *euca_home) {
         }
     }
 
+    char *mode = configFileValue(EMITTER_MODE_CONF_PARAM_NAME);
+    if(mode != NULL && strcmp(mode, EMITTER_MODE_SEGMENTS) == 0) {
+        char dir[EUCA_MAX_PATH] = "";
+        snprintf(dir, sizeof(dir), "%s/%s", get_stats_output_path(), SEGMENT_DIR_NAME);
+        if(init_segments(dir, TRUE) != EUCA_OK) {
+            LOGERROR("Cannot initialize event segments in %s\n", dir);
+            EUCA_FREE(mode);
+            return EUCA_ERROR;
+        }
+    } else if(mode != NULL && strlen(mode) > 0 && strcmp(mode, EMITTER_MODE_FILES) != 0) {
+        LOGWARN("Unknown %s value '%s', using '%s'\n", EMITTER_MODE_CONF_PARAM_NAME, mode, EMITTER_MODE_FILES);
+    }
+    EUCA_FREE(mode);
+
     LOGINFO("FS emitter initialization complete\n");
     return EUCA_OK;
 }
 
 //!
-//! Synchronously offer an event to the emitter. Emits the event at this time, no batching/queues
+//! Offer an event to the emitter. In the files mode, emits the event at this time. In the
+//! segments mode, the event is written with the others of the pass by emitter_flush(), or
+//! earlier if the pending events reach SEGMENT_GROUP_MAX_BYTES.
 //! 
 //! @param json document to emit
 //! @returns 0 on success, error code != 0 on failure
@@ -217,9 +268,405 @@ int emitter_offer_event(json_object *event) {
     if(event == NULL) {
         return EUCA_ERROR;
     }
+    if(segments_enabled) {
+        return append_event(event);
+    }
     return write_event_to_file(event);
 }
 
+//!
+//! Writes the pending events to the newest segment with a single write, then syncs it. Starts
+//! a new segment first if they do not fit in the current one. Nothing to do in the files mode.
+//!
+//! @returns EUCA_OK on success, EUCA_IO_ERROR if the events could not be written, in which case
+//!          they are dropped and the next flush starts a new segment
+//!
+int emitter_flush() {
+    int result = EUCA_OK;
+
+    if(!segments_enabled || pending_len == 0) {
+        return EUCA_OK;
+    }
+
+    if(segment_fd >= 0 && segment_size > 0 && (segment_size + pending_len) > segment_max_bytes) {
+        close_segment();
+    }
+
+    if(segment_fd < 0 && open_next_segment() != EUCA_OK) {
+        result = EUCA_IO_ERROR;
+    } else if(write_all(segment_fd, pending_events, pending_len) != EUCA_OK || fdatasync(segment_fd) != 0) {
+        LOGERROR("Error writing %zu bytes of events to segment in %s: %s\n", pending_len, segment_dir, strerror(errno));
+        close_segment();
+        result = EUCA_IO_ERROR;
+    } else {
+        LOGTRACE("Wrote %zu bytes of events to segment in %s\n", pending_len, segment_dir);
+        segment_size += pending_len;
+    }
+
+    pending_len = 0;
+    return result;
+}
+
+//!
+//! Reads the events after an offset, in the order they were written, and advances the offset
+//! past each event the callback accepts. Segments removed before being read are skipped, as is
+//! an event cut short in a segment that is no longer the newest (by a crash of the writer).
+//!
+//! @param[in]     segment_dir directory of the segments
+//! @param[in,out] offset next event to read. A segment number <= 0 starts from the oldest event.
+//! @param[in]     max_events maximum number of events to read, <= 0 for all of them
+//! @param[in]     event_fn called with each event, which is not nul terminated. A return other
+//!                than EUCA_OK stops the read before that event.
+//! @param[in]     data passed to event_fn
+//! @param[out]    read_count number of events accepted by event_fn
+//!
+//! @returns EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters, EUCA_IO_ERROR if a segment
+//!          cannot be read, or what event_fn returned
+//!
+int emitter_read_events(const char *segment_dir, emitter_offset *offset, int max_events, int (*event_fn)(const char *event, size_t len, void *data), void *data, int *read_count) {
+    int i = 0;
+    int fd = -1;
+    int count = 0;
+    int result = EUCA_OK;
+    long long *numbers = NULL;
+    char *buf = NULL;
+    char *start = NULL;
+    char *end = NULL;
+    char path[EUCA_MAX_PATH] = "";
+    ssize_t got = 0;
+    size_t len = 0;
+    struct stat st = { 0 };
+
+    if(segment_dir == NULL || offset == NULL || event_fn == NULL || read_count == NULL) {
+        return EUCA_INVALID_ERROR;
+    }
+    *read_count = 0;
+
+    if(list_segments(segment_dir, &numbers, &count) != EUCA_OK) {
+        return EUCA_IO_ERROR;
+    }
+
+    for(i = 0; i < count && numbers[i] < offset->segment; i++);
+    if(i == count) {
+        //Nothing written past the offset yet
+        EUCA_FREE(numbers);
+        return EUCA_OK;
+    }
+    if(numbers[i] != offset->segment) {
+        if(offset->segment > 0) {
+            LOGWARN("Event segment %lld is gone, events were lost up to segment %lld\n", offset->segment, numbers[i]);
+        }
+        offset->segment = numbers[i];
+        offset->position = 0;
+    }
+
+    for( ; i < count && result == EUCA_OK; i++) {
+        if(numbers[i] != offset->segment) {
+            offset->segment = numbers[i];
+            offset->position = 0;
+        }
+
+        get_segment_path(segment_dir, offset->segment, path, sizeof(path));
+        if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0) {
+            LOGERROR("Cannot read event segment %s: %s\n", path, strerror(errno));
+            result = EUCA_IO_ERROR;
+            break;
+        }
+
+        if(st.st_size < offset->position) {
+            LOGERROR("Offset %lld is past the end of event segment %s\n", offset->position, path);
+            result = EUCA_INVALID_ERROR;
+        } else if(st.st_size > offset->position) {
+            len = st.st_size - offset->position;
+            if((buf = EUCA_ALLOC(len, sizeof(char))) == NULL) {
+                result = EUCA_MEMORY_ERROR;
+            } else if((got = pread(fd, buf, len, offset->position)) < 0) {
+                LOGERROR("Cannot read event segment %s: %s\n", path, strerror(errno));
+                result = EUCA_IO_ERROR;
+            } else {
+                for(start = buf; result == EUCA_OK && (end = memchr(start, '\n', (buf + got) - start)) != NULL; start = end + 1) {
+                    if(max_events > 0 && *read_count >= max_events) {
+                        break;
+                    }
+                    if((result = event_fn(start, end - start, data)) == EUCA_OK) {
+                        offset->position += (end - start) + 1;
+                        (*read_count)++;
+                    }
+                }
+                if(result == EUCA_OK && end == NULL && start < (buf + got) && (i + 1) < count) {
+                    LOGWARN("Skipping %lld bytes of partial event at the end of event segment %s\n", (long long)((buf + got) - start), path);
+                }
+            }
+            EUCA_FREE(buf);
+        }
+        close(fd);
+
+        if(max_events > 0 && *read_count >= max_events) {
+            break;
+        }
+    }
+
+    EUCA_FREE(numbers);
+    return result;
+}
+
+//!
+//! Loads the offset a consumer stored in the segment directory
+//!
+//! @param[in]  segment_dir directory of the segments
+//! @param[in]  consumer name of the consumer, without '/'
+//! @param[out] offset stored offset, or the oldest event if the consumer has none yet
+//!
+//! @returns EUCA_OK on success, EUCA_INVALID_ERROR on a bad name, or EUCA_IO_ERROR if the
+//!          offset file cannot be read
+//!
+int emitter_load_offset(const char *segment_dir, const char *consumer, emitter_offset *offset) {
+    int result = EUCA_OK;
+    FILE *fp = NULL;
+    char path[EUCA_MAX_PATH] = "";
+
+    if(offset == NULL || get_offset_path(segment_dir, consumer, path, sizeof(path)) != EUCA_OK) {
+        return EUCA_INVALID_ERROR;
+    }
+
+    offset->segment = 0;
+    offset->position = 0;
+    if((fp = fopen(path, "r")) == NULL) {
+        if(errno == ENOENT) {
+            return EUCA_OK;
+        }
+        LOGERROR("Cannot read event offset of %s from %s: %s\n", consumer, path, strerror(errno));
+        return EUCA_IO_ERROR;
+    }
+
+    if(fscanf(fp, "%lld %lld", &offset->segment, &offset->position) != 2 || offset->position < 0) {
+        LOGERROR("Invalid event offset of %s in %s\n", consumer, path);
+        offset->segment = 0;
+        offset->position = 0;
+        result = EUCA_IO_ERROR;
+    }
+    fclose(fp);
+    return result;
+}
+
+//!
+//! Stores the offset of a consumer in the segment directory, replacing the previous one at once
+//!
+//! @param[in] segment_dir directory of the segments
+//! @param[in] consumer name of the consumer, without '/'
+//! @param[in] offset offset to store
+//!
+//! @returns EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters, or EUCA_IO_ERROR if the
+//!          offset file cannot be written
+//!
+int emitter_store_offset(const char *segment_dir, const char *consumer, const emitter_offset *offset) {
+    char path[EUCA_MAX_PATH] = "";
+    char tmp_path[EUCA_MAX_PATH] = "";
+    char line[64] = "";
+
+    if(offset == NULL || get_offset_path(segment_dir, consumer, path, sizeof(path)) != EUCA_OK) {
+        return EUCA_INVALID_ERROR;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s%s", path, DATA_FILENAME_TEMP_SUFFIX);
+    snprintf(line, sizeof(line), "%lld %lld\n", offset->segment, offset->position);
+    if(str2file(line, tmp_path, O_CREAT | O_WRONLY | O_TRUNC, OUTPUT_DATA_PERM, FALSE) != EUCA_OK || rename(tmp_path, path) == -1) {
+        LOGERROR("Cannot store event offset of %s in %s\n", consumer, path);
+        remove(tmp_path);
+        return EUCA_IO_ERROR;
+    }
+    return EUCA_OK;
+}
+
+//! Switches the emitter to the segments mode, writing to the given directory
+static int init_segments(const char *dir, int chown) {
+    if(dir == NULL || ensure_directories_exist(dir, 0, DATA_OUTPUT_USER, DATA_OUTPUT_GROUP, DATA_DIR_PERM) < 0) {
+        LOGERROR("Cannot find event segment directory %s\n", dir);
+        return EUCA_ERROR;
+    }
+
+    euca_strncpy(segment_dir, dir, sizeof(segment_dir));
+    segment_chown = chown;
+    segments_enabled = TRUE;
+    LOGINFO("Emitting events to segments in %s\n", segment_dir);
+    return EUCA_OK;
+}
+
+//! Adds the event as a line to the pending events, writing them if enough are pending
+static int append_event(json_object *event) {
+    char *larger = NULL;
+    size_t needed = 0;
+    size_t len = 0;
+
+    if(get_sensor_name(event) == NULL) {
+        LOGERROR("Could not get sensorname from sensor event\n");
+        return EUCA_ERROR;
+    }
+
+    //Plain json has no newline, with those in strings escaped
+    const char *json_string = json_object_to_json_string_ext(event, JSON_C_TO_STRING_PLAIN);
+    if(json_string == NULL) {
+        LOGERROR("Error getting json string for sensor event\n");
+        return EUCA_ERROR;
+    }
+
+    len = strlen(json_string);
+    needed = pending_len + len + 1;
+    if(needed > pending_size) {
+        needed = (needed > SEGMENT_GROUP_MAX_BYTES) ? needed : SEGMENT_GROUP_MAX_BYTES;
+        if((larger = EUCA_REALLOC(pending_events, needed, sizeof(char))) == NULL) {
+            LOGERROR("Out of memory for pending events\n");
+            return EUCA_MEMORY_ERROR;
+        }
+        pending_events = larger;
+        pending_size = needed;
+    }
+
+    memcpy(pending_events + pending_len, json_string, len);
+    pending_events[pending_len + len] = '\n';
+    pending_len += len + 1;
+
+    if(pending_len >= SEGMENT_GROUP_MAX_BYTES) {
+        return emitter_flush();
+    }
+    return EUCA_OK;
+}
+
+//! Orders segment numbers
+static int compare_segments(const void *a, const void *b) {
+    long long x = *((const long long *)a);
+    long long y = *((const long long *)b);
+    return (x > y) - (x < y);
+}
+
+//! Gets the numbers of the segments of a directory, oldest first. The caller frees numbers.
+static int list_segments(const char *dir, long long **numbers, int *count) {
+    DIR *dp = NULL;
+    struct dirent *entry = NULL;
+    long long number = 0;
+    long long *larger = NULL;
+    int size = 0;
+    int used = 0;
+
+    *numbers = NULL;
+    *count = 0;
+    if((dp = opendir(dir)) == NULL) {
+        LOGERROR("Cannot list event segments in %s: %s\n", dir, strerror(errno));
+        return EUCA_IO_ERROR;
+    }
+
+    while((entry = readdir(dp)) != NULL) {
+        if(sscanf(entry->d_name, "%lld%n", &number, &used) != 1 || number <= 0 || strcmp(entry->d_name + used, SEGMENT_FILENAME_SUFFIX) != 0) {
+            continue;
+        }
+        if(*count == size) {
+            size = (size == 0) ? SEGMENTS_KEPT + 1 : size * 2;
+            if((larger = EUCA_REALLOC(*numbers, size, sizeof(long long))) == NULL) {
+                EUCA_FREE(*numbers);
+                *count = 0;
+                closedir(dp);
+                return EUCA_MEMORY_ERROR;
+            }
+            *numbers = larger;
+        }
+        (*numbers)[(*count)++] = number;
+    }
+    closedir(dp);
+
+    if(*count > 0) {
+        qsort(*numbers, *count, sizeof(long long), compare_segments);
+    }
+    return EUCA_OK;
+}
+
+//! Builds the path of a segment
+static void get_segment_path(const char *dir, long long number, char *path, size_t len) {
+    char name[64] = "";
+    snprintf(name, sizeof(name), SEGMENT_FILENAME_FORMAT, number);
+    snprintf(path, len, "%s/%s", dir, name);
+}
+
+//! Starts a segment after the newest one, then removes the oldest ones past SEGMENTS_KEPT.
+//! Segments are never appended to after a restart, so that only the newest one can be cut short.
+static int open_next_segment() {
+    int i = 0;
+    int count = 0;
+    long long *numbers = NULL;
+    long long next = 1;
+    char path[EUCA_MAX_PATH] = "";
+
+    if(list_segments(segment_dir, &numbers, &count) != EUCA_OK) {
+        return EUCA_IO_ERROR;
+    }
+    if(count > 0) {
+        next = numbers[count - 1] + 1;
+    }
+
+    get_segment_path(segment_dir, next, path, sizeof(path));
+    if((segment_fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, OUTPUT_DATA_PERM)) < 0) {
+        LOGERROR("Cannot create event segment %s: %s\n", path, strerror(errno));
+        EUCA_FREE(numbers);
+        return EUCA_IO_ERROR;
+    }
+    if(segment_chown && diskutil_ch(path, DATA_OUTPUT_USER, DATA_OUTPUT_GROUP, OUTPUT_DATA_PERM) != EUCA_OK) {
+        LOGERROR("Error setting ownership info on event segment %s\n", path);
+        close_segment();
+        unlink(path);
+        EUCA_FREE(numbers);
+        return EUCA_IO_ERROR;
+    }
+    segment_size = 0;
+    LOGDEBUG("Started event segment %s\n", path);
+
+    for(i = 0; i < (count + 1 - SEGMENTS_KEPT); i++) {
+        get_segment_path(segment_dir, numbers[i], path, sizeof(path));
+        if(unlink(path) != 0) {
+            LOGWARN("Cannot remove old event segment %s: %s\n", path, strerror(errno));
+        }
+    }
+
+    EUCA_FREE(numbers);
+    return EUCA_OK;
+}
+
+//! Closes the newest segment, the next flush starts another one
+static void close_segment() {
+    if(segment_fd >= 0) {
+        close(segment_fd);
+        segment_fd = -1;
+    }
+    segment_size = 0;
+}
+
+//! Writes the whole buffer, through short writes and interruptions
+static int write_all(int fd, const char *buf, size_t len) {
+    ssize_t written = 0;
+
+    while(len > 0) {
+        if((written = write(fd, buf, len)) < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return EUCA_IO_ERROR;
+        }
+        buf += written;
+        len -= written;
+    }
+    return EUCA_OK;
+}
+
+//! Builds the path of the offset file of a consumer
+static int get_offset_path(const char *dir, const char *consumer, char *path, size_t len) {
+    if(dir == NULL || consumer == NULL || strlen(consumer) == 0 || strchr(consumer, '/') != NULL) {
+        LOGERROR("Invalid event consumer name %s\n", SP(consumer));
+        return EUCA_INVALID_ERROR;
+    }
+    if(snprintf(path, len, "%s/%s%s", dir, consumer, SEGMENT_OFFSET_SUFFIX) >= len) {
+        return EUCA_INVALID_ERROR;
+    }
+    return EUCA_OK;
+}
+
 //! Replace the 'replace' char with the 'find' char in the string. Simple
 static void euca_chrreplace(char *haystack, char target, char replacement) {
     if(haystack == NULL) {
@@ -579,6 +1026,144 @@ static int test_write_event_to_file_highload() {
     }
 }
 
+//! Collects the events read into a json array
+static int test_collect_event(const char *event, size_t len, void *data) {
+    char line[MAX_JSON_LENGTH_TEST] = "";
+    json_object *obj = NULL;
+
+    snprintf(line, sizeof(line), "%.*s", (int)len, event);
+    if((obj = json_tokener_parse(line)) == NULL) {
+        LOGERROR("Read an invalid event: %s\n", line);
+        return EUCA_ERROR;
+    }
+    json_object_array_add((json_object *)data, obj);
+    return EUCA_OK;
+}
+
+//! Gets the "n" of an event read
+static int test_event_number(json_object *events, int i) {
+    json_object *n = NULL;
+    if(json_object_object_get_ex(json_object_array_get_idx(events, i), "n", &n) == FALSE) {
+        return -1;
+    }
+    return json_object_get_int(n);
+}
+
+static int test_segments() {
+    LOGINFO("\n-------------Testing segments----------------\n");
+    char dir[EUCA_MAX_PATH] = "/tmp/test_fs_emitter_XXXXXX";
+    char path[EUCA_MAX_PATH] = "";
+    char json[MAX_JSON_LENGTH_TEST] = "";
+    int i = 0;
+    int count = 0;
+    int read = 0;
+    int total = 0;
+    int result = EUCA_OK;
+    long long *numbers = NULL;
+    emitter_offset offset = { 0 };
+    emitter_offset loaded = { 0 };
+    json_object *event = NULL;
+    json_object *events = json_object_new_array();
+
+    if(safe_mkdtemp(dir) == NULL || init_segments(dir, FALSE) != EUCA_OK) {
+        LOGERROR("Cannot set up segments in %s\n", dir);
+        return EUCA_ERROR;
+    }
+
+    //An event without a sensor name
+    event = json_tokener_parse("{\"test\":\"value\"}");
+    if(emitter_offer_event(event) == EUCA_OK) {
+        LOGERROR("Accepted an event without a sensor name\n");
+        result = EUCA_ERROR;
+    }
+    json_object_put(event);
+
+    //Nothing is written until the flush
+    for(i = 0; i < 10; i++) {
+        snprintf(json, sizeof(json), "{\"sensor\":\"my.sensor\",\"n\":%d,\"text\":\"two\\nlines\"}", i);
+        event = json_tokener_parse(json);
+        emitter_offer_event(event);
+        json_object_put(event);
+    }
+    list_segments(dir, &numbers, &count);
+    EUCA_FREE(numbers);
+    if(count != 0) {
+        LOGERROR("Found %d segments before the flush\n", count);
+        result = EUCA_ERROR;
+    }
+
+    if(emitter_flush() != EUCA_OK || emitter_read_events(dir, &offset, 4, test_collect_event, events, &read) != EUCA_OK || read != 4) {
+        LOGERROR("Expected 4 events, read %d\n", read);
+        result = EUCA_ERROR;
+    }
+    if(emitter_store_offset(dir, "test", &offset) != EUCA_OK || emitter_load_offset(dir, "test", &loaded) != EUCA_OK
+       || loaded.segment != offset.segment || loaded.position != offset.position || emitter_store_offset(dir, "../test", &offset) == EUCA_OK) {
+        LOGERROR("Stored offset %lld:%lld, loaded %lld:%lld\n", offset.segment, offset.position, loaded.segment, loaded.position);
+        result = EUCA_ERROR;
+    }
+
+    //Events get over several segments, the oldest ones removed
+    segment_max_bytes = 200;
+    for(i = 10; i < 100; i++) {
+        snprintf(json, sizeof(json), "{\"sensor\":\"my.sensor\",\"n\":%d,\"text\":\"two\\nlines\"}", i);
+        event = json_tokener_parse(json);
+        emitter_offer_event(event);
+        json_object_put(event);
+        emitter_flush();
+    }
+    segment_max_bytes = SEGMENT_MAX_BYTES;
+    list_segments(dir, &numbers, &count);
+    if(count != SEGMENTS_KEPT) {
+        LOGERROR("Expected %d segments, got %d\n", SEGMENTS_KEPT, count);
+        result = EUCA_ERROR;
+    }
+
+    //A partial event at the end of a sealed segment is skipped
+    if(count > 1) {
+        get_segment_path(dir, numbers[count - 2], path, sizeof(path));
+        int fd = open(path, O_WRONLY | O_APPEND);
+        write(fd, "{\"sensor\":", 10);
+        close(fd);
+    }
+
+    //Reading resumes at the oldest segment left
+    if(emitter_read_events(dir, &loaded, 0, test_collect_event, events, &read) != EUCA_OK || loaded.segment != numbers[count - 1]) {
+        LOGERROR("Read up to %lld:%lld\n", loaded.segment, loaded.position);
+        result = EUCA_ERROR;
+    }
+    total = json_object_array_length(events);
+    for(i = 1; i < total; i++) {
+        if(test_event_number(events, i) <= test_event_number(events, i - 1)) {
+            LOGERROR("Events read out of order at %d\n", i);
+            result = EUCA_ERROR;
+        }
+    }
+    LOGINFO("Read %d events, the last one %d\n", total, test_event_number(events, total - 1));
+    if(test_event_number(events, total - 1) != 99) {
+        LOGERROR("Last event read is not the last written\n");
+        result = EUCA_ERROR;
+    }
+
+    //Nothing new
+    if(emitter_read_events(dir, &loaded, 0, test_collect_event, events, &read) != EUCA_OK || read != 0) {
+        LOGERROR("Read %d events again\n", read);
+        result = EUCA_ERROR;
+    }
+
+    close_segment();
+    segments_enabled = FALSE;
+    for(i = 0; i < count; i++) {
+        get_segment_path(dir, numbers[i], path, sizeof(path));
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/test%s", dir, SEGMENT_OFFSET_SUFFIX);
+    unlink(path);
+    rmdir(dir);
+    EUCA_FREE(numbers);
+    json_object_put(events);
+    return result;
+}
+
 const char * test_output_path = "unit_test_output";
 
 int main(int argc, char** argv) {
@@ -611,6 +1196,9 @@ int main(int argc, char** argv) {
     ++test_count && (test_write_event_to_file() == EUCA_OK) ? success_count++ : failure_count++;    
     LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
 
+    ++test_count && (test_segments() == EUCA_OK) ? success_count++ : failure_count++;
+    LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
+
     //Test performance and lots of data
     //++test_count && (test_write_event_to_file_highload() == EUCA_OK) ? success_count++ : failure_count++;    
     LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
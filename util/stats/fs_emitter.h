@@ -100,6 +100,23 @@
 #define DATA_DIR_PERM 0755
 #define OUTPUT_DATA_PERM 0640
 
+//! How events are written, set with STATS_EMITTER_MODE in eucalyptus.conf
+#define EMITTER_MODE_CONF_PARAM_NAME "STATS_EMITTER_MODE"
+#define EMITTER_MODE_FILES "files"          //!< a file per sensor, replaced by each of its events
+#define EMITTER_MODE_SEGMENTS "segments"    //!< all events appended to rotating segment files
+#define EMITTER_MODE_CONF_PARAM_DEFAULT EMITTER_MODE_FILES
+
+//! In segments mode, each event is a line of json (NDJSON) appended to the newest segment of
+//! SEGMENT_DIR_NAME, under the stats output directory. Segments are numbered in the order they
+//! are written. A segment only ever grows, until it is sealed by the creation of the next one.
+#define SEGMENT_DIR_NAME "events"
+#define SEGMENT_FILENAME_SUFFIX ".ndjson"
+#define SEGMENT_FILENAME_FORMAT "%020lld" SEGMENT_FILENAME_SUFFIX
+#define SEGMENT_MAX_BYTES (4 * 1024 * 1024)         //!< a new segment is started once one reaches this size
+#define SEGMENTS_KEPT 16                    //!< older segments are removed, whether or not they were consumed
+#define SEGMENT_GROUP_MAX_BYTES (256 * 1024)        //!< pending events are written before the end of a pass past this size
+#define SEGMENT_OFFSET_SUFFIX ".offset"     //!< of the files where consumers keep their offsets
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -118,6 +135,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Position of a consumer in the segments: the next event it reads
+typedef struct emitter_offset_t {
+    long long segment;                 //!< number of the segment
+    long long position;                //!< byte offset of the event in the segment
+} emitter_offset;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -132,6 +155,14 @@
 
 int init_emitter();
 int emitter_offer_event(json_object *event);
+int emitter_flush();
+
+//! @{
+//! @name consumer side of the segments mode
+int emitter_read_events(const char *segment_dir, emitter_offset *offset, int max_events, int (*event_fn)(const char *event, size_t len, void *data), void *data, int *read_count);
+int emitter_load_offset(const char *segment_dir, const char *consumer, emitter_offset *offset);
+int emitter_store_offset(const char *segment_dir, const char *consumer, const emitter_offset *offset);
+//! @}
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
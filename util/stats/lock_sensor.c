@@ -0,0 +1,293 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/lock_sensor.c
+//! Semaphore contention sensor, reporting the statistics kept by util/ipc.c
+//! for the semaphores registered with sem_stats_register()
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "lock_sensor.h"
+#include "sensor_common.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <eucalyptus.h>
+#include <euca_string.h>
+#include <string.h>
+#include <log.h>
+#include <ipc.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static int lock_sensor_ttl = 0;
+static char interval_tag[SENSOR_TAG_MAX];
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static json_object *build_histogram(const long long *hist);
+static void lock_sensor_toggle(int enabled);
+static json_object *lock_sensor_values_call();
+
+#ifdef _UNIT_TEST
+static int test_lock_sensor();
+
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Builds the array of counts of a histogram whose buckets are powers of 10 usec:
+//! below 10us, below 100us, ..., and the last one for anything longer
+static json_object *build_histogram(const long long *hist) {
+    json_object *array = json_object_new_array();
+
+    for (int i = 0; i < SEM_STATS_BUCKETS; i++) {
+        json_object_array_add(array, json_object_new_int64(hist[i]));
+    }
+    return array;
+}
+
+//! Collection only costs while the sensor is enabled
+static void lock_sensor_toggle(int enabled) {
+    LOGINFO("%s semaphore statistics\n", (enabled ? "Collecting" : "No longer collecting"));
+    sem_stats_collect(enabled ? TRUE : FALSE);
+}
+
+//! Gets the statistics of the registered semaphores and builds one value set
+//! per semaphore, keyed by its label.
+static json_object *lock_sensor_values_call() {
+    int len = 0;
+    semStats *stats = NULL;
+    json_object *lock_data;
+    json_object *sem_data;
+
+    if (sem_stats_get(&stats, &len) != EUCA_OK) {
+        LOGERROR("Failed to get semaphore statistics\n");
+        return NULL;
+    }
+
+    lock_data = json_object_new_object();
+    for (int i = 0; i < len; i++) {
+        sem_data = json_object_new_object();
+        json_object_object_add(sem_data, "acquisitions", json_object_new_int64(stats[i].acquisitions));
+        json_object_object_add(sem_data, "wait_usec", json_object_new_int64(stats[i].wait_usec));
+        json_object_object_add(sem_data, "hold_usec", json_object_new_int64(stats[i].hold_usec));
+        json_object_object_add(sem_data, "wait_histogram", build_histogram(stats[i].wait_hist));
+        json_object_object_add(sem_data, "hold_histogram", build_histogram(stats[i].hold_hist));
+        json_object_object_add(sem_data, "max_hold_usec", json_object_new_int64(stats[i].max_hold_usec));
+        json_object_object_add(sem_data, "max_hold_site", json_object_new_string(stats[i].max_hold_site));
+        json_object_object_add(lock_data, stats[i].label, sem_data);
+    }
+    EUCA_FREE(stats);
+    return lock_data;
+}
+
+//! Entry point for the lock sensor
+json_object *lock_sensor_call() {
+    json_object *lock_data;
+    json_object *event_json;
+    json_object *tags;
+
+    if ((lock_data = lock_sensor_values_call()) == NULL) {
+        return NULL;
+    }
+
+    tags = build_tag_set(1, interval_tag);
+    //The output gets its own copy of the values
+    event_json = build_sensor_output(lock_sensor.sensor_name, LOCK_SENSOR_DESCRIPTION, time(NULL), lock_sensor_ttl, tags, lock_data);
+    json_object_put(lock_data);
+
+    if(event_json == NULL) {
+        LOGERROR("Failed in lock stats output generation.");
+        return NULL;
+    }
+
+    return event_json;
+}
+
+//! Idempotently initialize the lock sensor structures. Not threadsafe.
+int initialize_lock_sensor(const char *service_name, int interval, int event_ttl) {
+    if(service_name == NULL || event_ttl < 0) {
+        LOGERROR("Invalid initialization values for lock sensor. Cannot initialize\n");
+        return EUCA_ERROR;
+    }
+
+    LOGINFO("Initializing lock sensor for component %s\n", service_name);
+    euca_strncpy(lock_sensor.config_name, LOCK_SENSOR_NAME, SENSOR_NAME_MAX);
+    snprintf(lock_sensor.sensor_name, SENSOR_NAME_MAX, LOCK_SENSOR_NAME_FORMAT, service_name);
+    lock_sensor.enabled = 0;
+    lock_sensor.sensor_function = lock_sensor_call;
+    lock_sensor.state_toggle_callback = lock_sensor_toggle;
+    lock_sensor.values_function = lock_sensor_values_call;
+
+    lock_sensor_ttl = event_ttl;
+    snprintf(interval_tag, SENSOR_TAG_MAX, SENSOR_INTERVAL_PERIOD_TAG_FORMAT, interval);
+
+    return EUCA_OK;
+}
+
+#ifdef _UNIT_TEST
+
+int test_lock_sensor() {
+    int test_ttl = 60;
+    sem *test_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    json_object *event = NULL;
+
+    if (test_sem == NULL || sem_stats_register(test_sem, "test_sem") != EUCA_OK) {
+        return 1;
+    }
+    initialize_lock_sensor("nc", test_ttl, test_ttl);
+    lock_sensor_toggle(1);
+    for (int i = 0; i < 10; i++) {
+        sem_p(test_sem);
+        usleep(i * 100);
+        sem_v(test_sem);
+    }
+    if ((event = lock_sensor_call()) == NULL) {
+        return 1;
+    }
+    LOGINFO("Result map: %s\n", json_object_to_json_string_ext(event, JSON_C_TO_STRING_PRETTY));
+    json_object_put(event);
+    sem_free(test_sem);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if(test_lock_sensor() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return 0;
+}
+#endif
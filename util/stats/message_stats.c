@@ -80,7 +80,8 @@
 #include <log.h>
 #include <ipc.h>
 #include <json/json.h>
-#include <math.h>
+#include <euca_string.h>
+#include <hash.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -88,6 +89,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_USED 2
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -127,28 +132,23 @@
 \*----------------------------------------------------------------------------*/
 
 /*
-Stats map is json mapping. Each message is named and has an associated nested map containing the
-useful stats. The stats tracked are: count, success_count, failed_count, mean, min, max all in milliseconds of duration. 
-Example:
+Stats are kept in a fixed array of slots, one per message type, found by hashing the message
+name with linear probing. A slot is claimed once, with a compare-and-swap, and never released,
+so the lookup never needs a lock. All counters are updated with atomic operations, which also
+work on the CC's memory region shared between processes. Handling times go to a log-bucketed
+histogram from which the percentiles are computed. Only when the sensor emits are the slots
+read, zeroed and serialized to json.
+Example output:
 {
-  "describeResources": { "min": 10, "max"; 20, "mean":12.3},
-  "describeSensors": { "min": 10, "max"; 40, "mean":24.3},
-  "runInstance": { "min": 15, "max"; 20, "mean":33.3},
-  "attachVolume": { "min": 35, "max"; 100, "mean":76.3}
+  "enabled": true,
+  "describeResources": { "count": 3, "success_count": 3, "failure_count": 0, "mean": 12.3, "min": 10, "max": 20,
+                         "p50": 11, "p95": 20, "p99": 20, "p999": 20 },
+  "runInstance": { ... }
 }
 */
 
-/*
-Uses a map as input to the update and fetch systems. This is entirely due to
-the memory model of the CC and how it must share memory between processes.
-
-The stats system assumes that the actual stats state is shared memory managed
-externally (or not, as in the case of the NC), and is provided directly to these
-methods as a json string.
- */
-
 #ifdef _UNIT_TEST
-json_object *message_stats_map;
+message_stats_state message_stats_map;
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -156,18 +156,25 @@ json_object *message_stats_map;
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
-static double calculate_moving_mean(double current_mean, int current_count, long new_value);
+//! Histogram bucket of a handling time
+static int get_bucket(long long timing_ms);
 
-//! Constructs a new json object for the message statistics, but not for any specific message, no name used
-static json_object *initialize_new_message_map();
+//! Highest handling time that falls in the given bucket
+static long long get_bucket_max(int bucket);
 
-//! Zero the stats for a single message entry.
-static void reset_message_stat(json_object *msg_entry);
+//! Finds the slot of a message type, claiming a free one for it if create is set
+static message_stat *find_message_stat(message_stats_state *stats_state, const char *message_name, int create);
+
+//! Copies a slot's counters, zeroing them as they are read if reset is set
+static void snapshot_message_stat(message_stat *msg_stat, message_stat *snapshot, int reset);
+
+//! Builds the json map of the stats of a single message
+static json_object *build_message_map(const message_stat *snapshot);
 
 #ifdef _UNIT_TEST
-static int test_moving_average();
-static int test_init_message_map();
+static int test_buckets();
 static int test_update_message_stats();
+static int test_get_message_stats_json();
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -182,266 +189,289 @@ static int test_update_message_stats();
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-//! Calculate a cumulative moving averaged using the standard method
-static double calculate_moving_mean(double current_mean, int current_count, long new_value) {
-    return current_mean + ( ((double)new_value - current_mean ) / (current_count + 1) );
-}
+//! Values below MSG_HIST_SUB_BUCKETS get a bucket each. Above, the bucket is given by the
+//! position of the highest bit set and the MSG_HIST_SUB_BITS bits that follow it.
+static int get_bucket(long long timing_ms) {
+    unsigned int value = 0;
+    int msb = 0;
 
-//! Returns a new message map for the named message type
-//! If cached_map != NULL, reads in that value and initializes the structure with that state.
-//! This is necessary for the CC's memory model.
-static json_object *initialize_new_message_map() {
-    json_object *default_fields = json_object_new_object();
-    json_object_object_add(default_fields, MSG_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(default_fields, MSG_OK_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(default_fields, MSG_FAIL_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(default_fields, MSG_MEAN_KEY, json_object_new_double(MSG_MEAN_INIT));
-    json_object_object_add(default_fields, MSG_MIN_KEY, json_object_new_int(MSG_MIN_INIT)); //Use -1 since it is invalid measure
-    json_object_object_add(default_fields, MSG_MAX_KEY, json_object_new_int(MSG_MAX_INIT));
-    return default_fields;
+    if(timing_ms <= 0) {
+        return 0;
+    }
+    value = (timing_ms > 0xFFFFFFFFLL) ? 0xFFFFFFFF : (unsigned int)timing_ms;
+    if(value < MSG_HIST_SUB_BUCKETS) {
+        return value;
+    }
+
+    msb = 31 - __builtin_clz(value);
+    return ((msb - MSG_HIST_SUB_BITS + 1) << MSG_HIST_SUB_BITS) + ((value >> (msb - MSG_HIST_SUB_BITS)) & (MSG_HIST_SUB_BUCKETS - 1));
 }
 
-//! Resets the counters for the given message entry. Expects that the json object passed
-//! is the map of values for a single message entry. Modifies the entry in-place
-static void reset_message_stat(json_object *msg_entry) {
-    if(msg_entry == NULL || json_object_is_type(msg_entry, json_type_object)) {
-        return;
+//! Reverse of get_bucket(): the bucket covers 2^(group - 1) values, starting at
+//! (MSG_HIST_SUB_BUCKETS + sub-bucket) << (group - 1)
+static long long get_bucket_max(int bucket) {
+    int group = bucket >> MSG_HIST_SUB_BITS;
+    long long low = 0;
+
+    if(group == 0) {
+        return bucket;
     }
+    low = (long long)(MSG_HIST_SUB_BUCKETS + (bucket & (MSG_HIST_SUB_BUCKETS - 1))) << (group - 1);
+    return low + (1LL << (group - 1)) - 1;
+}
 
-    json_object_object_del(msg_entry, MSG_MEAN_KEY);
-    json_object_object_del(msg_entry, MSG_MIN_KEY);
-    json_object_object_del(msg_entry, MSG_MAX_KEY);
-    json_object_object_del(msg_entry, MSG_COUNT_KEY);
-    json_object_object_del(msg_entry, MSG_OK_COUNT_KEY);
-    json_object_object_del(msg_entry, MSG_FAIL_COUNT_KEY);
+//! Open addressing with linear probing. A free slot is claimed with a compare-and-swap, then
+//! named and published. A lookup that meets a slot being claimed waits for its name.
+static message_stat *find_message_stat(message_stats_state *stats_state, const char *message_name, int create) {
+    size_t len = strnlen(message_name, MSG_STATS_NAME_LEN - 1);
+    unsigned int start = (unsigned int)(euca_hash64(message_name, len, 0) % MSG_STATS_MAX_MESSAGES);
+    message_stat *msg_stat = NULL;
 
-    json_object_object_add(msg_entry, MSG_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(msg_entry, MSG_OK_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(msg_entry, MSG_FAIL_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(msg_entry, MSG_MEAN_KEY, json_object_new_double(MSG_MEAN_INIT));
-    json_object_object_add(msg_entry, MSG_MIN_KEY, json_object_new_int(MSG_MIN_INIT)); //Use -1 since it is invalid measure
-    json_object_object_add(msg_entry, MSG_MAX_KEY, json_object_new_int(MSG_MAX_INIT));
+    for(int i = 0; i < MSG_STATS_MAX_MESSAGES; i++) {
+        msg_stat = &(stats_state->messages[(start + i) % MSG_STATS_MAX_MESSAGES]);
 
-}
+        if(msg_stat->used == SLOT_FREE) {
+            if(!create) {
+                return NULL;
+            }
 
-//! Idempotently enable stats
-void enable_stats(json_object *stats_state) {
-    json_object *enabled_bool = NULL;
-    json_object_object_get_ex(stats_state, STATS_ENABLED_KEY, &enabled_bool);
-    if(enabled_bool == NULL || 
-       ( !json_object_is_type(enabled_bool, json_type_boolean) || 
-         json_object_get_boolean(enabled_bool) != TRUE) ) {
-
-        if(enabled_bool != NULL) {
-            json_object_object_del(stats_state, STATS_ENABLED_KEY);
+            if(__sync_bool_compare_and_swap(&(msg_stat->used), SLOT_FREE, SLOT_CLAIMED)) {
+                memcpy(msg_stat->name, message_name, len);
+                msg_stat->name[len] = '\0';
+                __sync_synchronize();
+                msg_stat->used = SLOT_USED;
+                return msg_stat;
+            }
         }
 
-        json_object_object_add(stats_state, STATS_ENABLED_KEY, json_object_new_boolean(TRUE));
-    }    
+        while(msg_stat->used == SLOT_CLAIMED) {
+            __sync_synchronize();
+        }
+
+        if(strncmp(msg_stat->name, message_name, len) == 0 && msg_stat->name[len] == '\0') {
+            return msg_stat;
+        }
+    }
+    return NULL;
 }
 
-int is_enabled(json_object *stats_state) {
-    json_object *enabled_bool = NULL;
-    json_object_object_get_ex(stats_state, STATS_ENABLED_KEY, &enabled_bool);
-    if(enabled_bool != NULL && json_object_is_type(enabled_bool, json_type_boolean)) {
-        return json_object_get_boolean(enabled_bool);
+//! Without reset, the counters are only read. With it, each is swapped with its initial value so
+//! that no update is lost, though one racing with the snapshot may be split across two intervals.
+static void snapshot_message_stat(message_stat *msg_stat, message_stat *snapshot, int reset) {
+    euca_strncpy(snapshot->name, msg_stat->name, MSG_STATS_NAME_LEN);
+    if(reset) {
+        snapshot->count = __sync_lock_test_and_set(&(msg_stat->count), MSG_COUNT_INIT);
+        snapshot->ok_count = __sync_lock_test_and_set(&(msg_stat->ok_count), MSG_COUNT_INIT);
+        snapshot->fail_count = __sync_lock_test_and_set(&(msg_stat->fail_count), MSG_COUNT_INIT);
+        snapshot->total_ms = __sync_lock_test_and_set(&(msg_stat->total_ms), 0);
+        snapshot->min_ms = __sync_lock_test_and_set(&(msg_stat->min_ms), MSG_MIN_INIT);
+        snapshot->max_ms = __sync_lock_test_and_set(&(msg_stat->max_ms), MSG_MAX_INIT);
+        for(int i = 0; i < MSG_HIST_BUCKETS; i++) {
+            snapshot->hist[i] = (msg_stat->hist[i] == 0) ? 0 : __sync_lock_test_and_set(&(msg_stat->hist[i]), 0);
+        }
     } else {
-        return FALSE;
+        snapshot->count = msg_stat->count;
+        snapshot->ok_count = msg_stat->ok_count;
+        snapshot->fail_count = msg_stat->fail_count;
+        snapshot->total_ms = msg_stat->total_ms;
+        snapshot->min_ms = msg_stat->min_ms;
+        snapshot->max_ms = msg_stat->max_ms;
+        memcpy(snapshot->hist, msg_stat->hist, sizeof(snapshot->hist));
     }
 }
 
-//! Idempotently disable stats
-void disable_stats(json_object *stats_state) {
-    json_object *enabled_bool = NULL;
-    json_object_object_get_ex(stats_state, STATS_ENABLED_KEY, &enabled_bool);
-    if(enabled_bool == NULL || 
-       (!json_object_is_type(enabled_bool, json_type_boolean) || json_object_get_boolean(enabled_bool) == TRUE)) {
-
-        if(enabled_bool != NULL) {
-            json_object_object_del(stats_state, STATS_ENABLED_KEY);
-        }
+//! The percentiles are the highest value of the bucket they fall in, kept within min and max
+long long get_message_percentile(const message_stat *msg_stat, double fraction) {
+    long long total = 0;
+    long long rank = 0;
+    long long seen = 0;
+    long long value = 0;
+    int i = 0;
 
-        json_object_object_add(stats_state, STATS_ENABLED_KEY, json_object_new_boolean(FALSE));
-    }        
-}
+    for(i = 0; i < MSG_HIST_BUCKETS; i++) {
+        total += msg_stat->hist[i];
+    }
+    if(total == 0) {
+        return MSG_MIN_INIT;
+    }
 
-//! Must ensure that this is called serially the first time. Once the mutex is initialized it is protected by locks
-//! @param stats_state - the current state, if any. Will be reset and set enabled. Does not empty memory, just resets counters
-int initialize_message_stats(json_object **stats_state) {
-    if(stats_state == NULL) {
-        LOGFATAL("Cannot initialize a NULL address pointer for stats\n");
-        return EUCA_INVALID_ERROR;
+    rank = (long long)(fraction * total + 0.5);
+    if(rank < 1) {
+        rank = 1;
+    } else if(rank > total) {
+        rank = total;
     }
 
-    return reset_message_stats(stats_state);
-}
+    for(i = 0; (i < (MSG_HIST_BUCKETS - 1)) && ((seen += msg_stat->hist[i]) < rank); i++) ;
+    value = get_bucket_max(i);
 
-//! Add a new data point to the message's stats
-int update_message_stats(json_object *stats_state, const char *message_name, int timing_ms, int failed) {
-    if(message_name == NULL) {
-        return EUCA_ERROR;
+    if(msg_stat->max_ms != MSG_MAX_INIT && value > msg_stat->max_ms) {
+        value = msg_stat->max_ms;
+    }
+    if(msg_stat->min_ms != MSG_MIN_INIT && value < msg_stat->min_ms) {
+        value = msg_stat->min_ms;
     }
+    return value;
+}
 
-    if(stats_state == NULL || !is_enabled(stats_state) ) {
-        //Stats are disabled, return ok
-        return EUCA_OK;
+//! Returns a new message map for the snapshot of a message's stats
+static json_object *build_message_map(const message_stat *snapshot) {
+    json_object *msg_map = json_object_new_object();
+    double mean = (snapshot->count > 0) ? ((double)snapshot->total_ms / snapshot->count) : MSG_MEAN_INIT;
+
+    json_object_object_add(msg_map, MSG_COUNT_KEY, json_object_new_int64(snapshot->count));
+    json_object_object_add(msg_map, MSG_OK_COUNT_KEY, json_object_new_int64(snapshot->ok_count));
+    json_object_object_add(msg_map, MSG_FAIL_COUNT_KEY, json_object_new_int64(snapshot->fail_count));
+    json_object_object_add(msg_map, MSG_MEAN_KEY, json_object_new_double(mean));
+    json_object_object_add(msg_map, MSG_MIN_KEY, json_object_new_int64(snapshot->min_ms)); //-1 if there were none
+    json_object_object_add(msg_map, MSG_MAX_KEY, json_object_new_int64(snapshot->max_ms));
+    json_object_object_add(msg_map, MSG_P50_KEY, json_object_new_int64(get_message_percentile(snapshot, 0.5)));
+    json_object_object_add(msg_map, MSG_P95_KEY, json_object_new_int64(get_message_percentile(snapshot, 0.95)));
+    json_object_object_add(msg_map, MSG_P99_KEY, json_object_new_int64(get_message_percentile(snapshot, 0.99)));
+    json_object_object_add(msg_map, MSG_P999_KEY, json_object_new_int64(get_message_percentile(snapshot, 0.999)));
+    return msg_map;
+}
+
+//! Idempotently enable stats
+void enable_stats(message_stats_state *stats_state) {
+    if(stats_state != NULL) {
+        stats_state->enabled = TRUE;
     }
+}
 
-    json_object *msg = NULL;
-    json_object_object_get_ex(stats_state, message_name, &msg);
-    json_object *min_obj, *max_obj, *mean_obj, *count_obj, *ok_obj, *fail_obj;
-    int min_val, max_val, count_val, ok_count, fail_count;
-    double mean_val;
-
-    if(msg == NULL) {
-        //Not found. Add it.
-        msg = initialize_new_message_map();
-        if(msg == NULL) {
-            LOGERROR("Failed to add message type %s to the message stats map", message_name);
-            return EUCA_ERROR;
-        }  else {
-            json_object_object_add(stats_state, message_name, msg);
-        }
+int is_enabled(message_stats_state *stats_state) {
+    return (stats_state != NULL && stats_state->enabled);
+}
+
+//! Idempotently disable stats
+void disable_stats(message_stats_state *stats_state) {
+    if(stats_state != NULL) {
+        stats_state->enabled = FALSE;
     }
+}
 
-    //Update the data
-    json_object_object_get_ex(msg, MSG_MEAN_KEY, &mean_obj);
-    if(mean_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
+//! Must ensure that this is called serially the first time, before any update.
+//! @param stats_state - the state to set up. Forgets all message types and sets it enabled.
+int initialize_message_stats(message_stats_state *stats_state) {
+    if(stats_state == NULL) {
+        LOGFATAL("Cannot initialize a NULL address pointer for stats\n");
+        return EUCA_INVALID_ERROR;
     }
-    mean_val = json_object_get_int(mean_obj);
 
-    json_object_object_get_ex(msg, MSG_MIN_KEY, &min_obj);
-    if(mean_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
+    bzero(stats_state, sizeof(*stats_state));
+    for(int i = 0; i < MSG_STATS_MAX_MESSAGES; i++) {
+        stats_state->messages[i].min_ms = MSG_MIN_INIT;
+        stats_state->messages[i].max_ms = MSG_MAX_INIT;
     }
-    min_val = json_object_get_int(min_obj);
+    enable_stats(stats_state);
+    return EUCA_OK;
+}
 
-    json_object_object_get_ex(msg, MSG_MAX_KEY, &max_obj);
-    if(max_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
+//! Add a new data point to the message's stats
+int update_message_stats(message_stats_state *stats_state, const char *message_name, long timing_ms, int failed) {
+    message_stat *msg_stat = NULL;
+    long long current = 0;
+
+    if(message_name == NULL) {
         return EUCA_ERROR;
     }
-    max_val = json_object_get_int(max_obj);
 
-    json_object_object_get_ex(msg, MSG_COUNT_KEY, &count_obj);
-    if(count_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
+    if(stats_state == NULL || !is_enabled(stats_state) ) {
+        //Stats are disabled, return ok
+        return EUCA_OK;
     }
-    count_val = json_object_get_int(count_obj);
 
-    json_object_object_get_ex(msg, MSG_OK_COUNT_KEY, &ok_obj);
-    if(ok_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
+    if((msg_stat = find_message_stat(stats_state, message_name, TRUE)) == NULL) {
+        LOGERROR("Failed to add message type %s to the message stats, all %d slots are used\n", message_name, MSG_STATS_MAX_MESSAGES);
         return EUCA_ERROR;
     }
-    ok_count = json_object_get_int(ok_obj);
 
-    json_object_object_get_ex(msg, MSG_COUNT_KEY, &fail_obj);
-    if(fail_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
+    if(timing_ms < 0) {
+        timing_ms = 0;
     }
-    fail_count = json_object_get_int(fail_obj);
 
-    mean_val = (int)trunc(calculate_moving_mean((double)mean_val, count_val, timing_ms));
-    json_object_object_del(msg, MSG_MEAN_KEY);
+    __sync_fetch_and_add(&(msg_stat->count), 1);
+    __sync_fetch_and_add((failed ? &(msg_stat->fail_count) : &(msg_stat->ok_count)), 1);
+    __sync_fetch_and_add(&(msg_stat->total_ms), timing_ms);
+    __sync_fetch_and_add(&(msg_stat->hist[get_bucket(timing_ms)]), 1);
 
-    json_object_object_add(msg, MSG_MEAN_KEY, json_object_new_int(mean_val));
-    
-    if(min_val == MSG_MIN_INIT || timing_ms < min_val) {
-        json_object_object_del(msg, MSG_MIN_KEY);
-        json_object_object_add(msg, MSG_MIN_KEY, json_object_new_int(timing_ms));
-    }
-    
-    if(max_val == MSG_MAX_INIT || timing_ms > max_val) {
-        json_object_object_del(msg, MSG_MAX_KEY);
-        json_object_object_add(msg, MSG_MAX_KEY, json_object_new_int(timing_ms));
+    while(((current = msg_stat->min_ms) == MSG_MIN_INIT) || (timing_ms < current)) {
+        if(__sync_bool_compare_and_swap(&(msg_stat->min_ms), current, timing_ms)) {
+            break;
+        }
     }
-    
-    json_object_object_del(msg, MSG_COUNT_KEY);
-    json_object_object_add(msg, MSG_COUNT_KEY, json_object_new_int(++count_val));
 
-    if(failed == 0) {
-        json_object_object_del(msg, MSG_OK_COUNT_KEY);
-        json_object_object_add(msg, MSG_OK_COUNT_KEY, json_object_new_int(++ok_count));
-    } else {
-        json_object_object_del(msg, MSG_FAIL_COUNT_KEY);
-        json_object_object_add(msg, MSG_FAIL_COUNT_KEY, json_object_new_int(++fail_count));
+    while(((current = msg_stat->max_ms) == MSG_MAX_INIT) || (timing_ms > current)) {
+        if(__sync_bool_compare_and_swap(&(msg_stat->max_ms), current, timing_ms)) {
+            break;
+        }
     }
 
     return EUCA_OK;
 }
 
-//! Iterate through and reset all message metrics for next interval
-//! Removes all current data and stats from memory
-int reset_message_stats(json_object **stats_state) {
+//! Iterate through and reset all message metrics for next interval.
+//! The message types already seen keep their slots.
+int reset_message_stats(message_stats_state *stats_state) {
+    message_stat snapshot;
+
     if(stats_state == NULL) {
         LOGERROR("Cannot reset message stats on null pointer\n");
         return EUCA_INVALID_ERROR;
     }
 
-    if(*stats_state != NULL) {
-        //In future versions of json-c (0.12 for sure), this returns an int to determine if count decremented.
-        //The CentOS version is old (0.10), but when available use the return value to ensure all refs are released
-        json_object_object_foreach(*stats_state, key, value) {
-            if(strcmp(key, STATS_ENABLED_KEY) != 0 && json_object_is_type(value, json_type_object)) {
-                reset_message_stat(value);
-            }
+    for(int i = 0; i < MSG_STATS_MAX_MESSAGES; i++) {
+        if(stats_state->messages[i].used == SLOT_USED) {
+            snapshot_message_stat(&(stats_state->messages[i]), &snapshot, TRUE);
         }
-    } else {
-        LOGTRACE("Reseting message stats to a new json object\n");
-        *stats_state = json_object_new_object();
-        enable_stats(*stats_state);
     }
     return EUCA_OK;
 }
 
-//! Entry point for the message stats sensor. Gets the stats data from
-//! the message maps and sends it to the emitter.
-json_object *get_message_stats_json(const char *message_stats_string) {
-    //Stringify and re-parse to create completely separate copy
-    if(message_stats_string != NULL) {
-        return json_tokener_parse(message_stats_string);
-    } else {
+//! Serializes the stats of all the message types seen so far, for the sensor to emit
+json_object *get_message_stats_json(message_stats_state *stats_state, int reset) {
+    json_object *stats_json = NULL;
+    message_stat snapshot;
+
+    if(stats_state == NULL) {
         return NULL;
     }
+
+    stats_json = json_object_new_object();
+    json_object_object_add(stats_json, STATS_ENABLED_KEY, json_object_new_boolean(is_enabled(stats_state)));
+    for(int i = 0; i < MSG_STATS_MAX_MESSAGES; i++) {
+        if(stats_state->messages[i].used == SLOT_USED) {
+            snapshot_message_stat(&(stats_state->messages[i]), &snapshot, reset);
+            json_object_object_add(stats_json, snapshot.name, build_message_map(&snapshot));
+        }
+    }
+    return stats_json;
 }
 
 
 #ifdef _UNIT_TEST
-static int test_moving_average() {
-    LOGINFO("Testing moving average calculation\n");
-    double cma = 0.0;
-    int count = 0;
-    double result;
-    result = calculate_moving_mean(cma, count, 1); 
-    if(result != 1.0) {
-        LOGERROR("Wrong answer %f\n", result);
-        return 1;
-    }
-    
-    cma = 1.0;
-    count = 1;    
-    result = calculate_moving_mean(cma, count, 2);
-    if(result != 1.5) {
-        LOGERROR("Wrong answer %f\n", result);
-        return 1;
+static int test_buckets() {
+    LOGINFO("Testing histogram buckets\n");
+    long long values[] = { 0, 1, 15, 16, 17, 31, 32, 33, 100, 1000, 65535, 65536, 1000000, 0xFFFFFFFFLL };
+
+    for(int i = 0; i < (sizeof(values) / sizeof(values[0])); i++) {
+        int bucket = get_bucket(values[i]);
+        long long high = get_bucket_max(bucket);
+        long long low = (bucket == 0) ? 0 : (get_bucket_max(bucket - 1) + 1);
+        if(bucket < 0 || bucket >= MSG_HIST_BUCKETS || values[i] < low || values[i] > high ||
+           (high - low) * MSG_HIST_SUB_BUCKETS > high) {
+            LOGERROR("Value %lld in bucket %d of [%lld, %lld]\n", values[i], bucket, low, high);
+            return 1;
+        }
     }
 
-    return 0;
-}
-
-static int test_init_message_map() {
-    json_object *map = initialize_new_message_map();
-    if(map != NULL) {
-        LOGINFO("Built: %s\n", json_object_to_json_string_ext(map, JSON_C_TO_STRING_PRETTY));
-        return 0;
+    for(int i = 1; i < MSG_HIST_BUCKETS; i++) {
+        if(get_bucket(get_bucket_max(i - 1) + 1) != i) {
+            LOGERROR("Bucket %d does not follow bucket %d\n", i, i - 1);
+            return 1;
+        }
     }
-    return 1;
+    return 0;
 }
 
 static int test_update_message_stats() {
@@ -451,54 +481,46 @@ static int test_update_message_stats() {
         return 1;
     }
     
-    if(update_message_stats(message_stats_map, "runInstance", 100, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "runInstance", 100, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    if(update_message_stats(message_stats_map, "runInstance", 125, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "runInstance", 125, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    if(update_message_stats(message_stats_map, "runInstance", 75, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "runInstance", 75, 1) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    if(update_message_stats(message_stats_map, "runInstance", 50, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "runInstance", 50, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    if(update_message_stats(message_stats_map, "describeInstances", 50, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "describeInstances", 50, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    if(update_message_stats(message_stats_map, "terminateInstance", 50, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "terminateInstance", 50, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
     
     //Verify
-    json_object * inst = NULL;
-    json_object_object_get_ex(message_stats_map, "runInstance", &inst);
-    LOGINFO("Message stats: \n%s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
-    json_object *msg_count, *msg_max, *msg_min, *msg_mean;
-    msg_count = NULL;
-    msg_max = NULL;
-    msg_min = NULL;
-    msg_mean = NULL;
-    json_object_object_get_ex(inst, MSG_COUNT_KEY, &msg_count);
-    json_object_object_get_ex(inst, MSG_MAX_KEY, &msg_max);
-    json_object_object_get_ex(inst, MSG_MIN_KEY, &msg_min);
-    json_object_object_get_ex(inst, MSG_MEAN_KEY, &msg_mean);
+    message_stat *inst = find_message_stat(&message_stats_map, "runInstance", FALSE);
     if(inst != NULL && 
-       json_object_get_int(msg_count) == 4 &&
-       json_object_get_int(msg_max) == 125 &&
-       json_object_get_double(msg_mean) == ((100.0+125.0+75.0+50.0)/4.0) && 
-       json_object_get_int(msg_min) == 50) {
+       inst->count == 4 &&
+       inst->ok_count == 3 &&
+       inst->fail_count == 1 &&
+       inst->max_ms == 125 &&
+       inst->total_ms == (100+125+75+50) && 
+       inst->min_ms == 50 &&
+       find_message_stat(&message_stats_map, "attachVolume", FALSE) == NULL) {
         LOGINFO("test passes\n");
         return 0;
     } else {
@@ -508,28 +530,59 @@ static int test_update_message_stats() {
 }
 
 static int test_get_message_stats_json() {
-    LOGINFO("Testing update message stats\n");
+    LOGINFO("Testing message stats json and percentiles\n");
+    json_object *stats_json = NULL;
+    json_object *inst = NULL;
+    json_object *value = NULL;
+    long long p50 = 0, p99 = 0, p999 = 0;
+
     if(initialize_message_stats(&message_stats_map) != 0) {
         LOGERROR("Failed to initialize the structures\n");
         return 1;
     }
     
-    if(update_message_stats(message_stats_map, "runInstance", 100, 0) != 0) {
-        LOGERROR("Error updating stats\n");
-        return 1;
+    //1..1000 ms, so the percentiles are known
+    for(int i = 1; i <= 1000; i++) {
+        if(update_message_stats(&message_stats_map, "runInstance", i, 0) != 0) {
+            LOGERROR("Error updating stats\n");
+            return 1;
+        }
     }
-    
-    LOGINFO("Got intermediate result: %s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
 
-    if(update_message_stats(message_stats_map, "runInstance", 125, 0) != 0) {
-        LOGERROR("Error updating stats\n");
+    stats_json = get_message_stats_json(&message_stats_map, TRUE);
+    LOGINFO("Result: %s\n", json_object_to_json_string_ext(stats_json, JSON_C_TO_STRING_PRETTY));
+    json_object_object_get_ex(stats_json, "runInstance", &inst);
+    if(inst == NULL) {
+        LOGERROR("runInstance not found\n");
+        json_object_put(stats_json);
         return 1;
     }
+    json_object_object_get_ex(inst, MSG_P50_KEY, &value);
+    p50 = json_object_get_int64(value);
+    json_object_object_get_ex(inst, MSG_P99_KEY, &value);
+    p99 = json_object_get_int64(value);
+    json_object_object_get_ex(inst, MSG_P999_KEY, &value);
+    p999 = json_object_get_int64(value);
+    json_object_object_get_ex(inst, MSG_MEAN_KEY, &value);
+    if(p50 < 500 || p50 > (500 + 500 / MSG_HIST_SUB_BUCKETS) || p99 < 990 || p999 < 999 || p999 > 1000 ||
+       json_object_get_double(value) != 500.5) {
+        LOGERROR("Wrong percentiles p50=%lld p99=%lld p999=%lld\n", p50, p99, p999);
+        json_object_put(stats_json);
+        return 1;
+    }
+    json_object_put(stats_json);
 
-    LOGINFO("Post-update result: %s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
-
-    LOGINFO("Internal state result: %s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
-    
+    //The read reset the counters but kept the message
+    inst = NULL;
+    stats_json = get_message_stats_json(&message_stats_map, FALSE);
+    json_object_object_get_ex(stats_json, "runInstance", &inst);
+    json_object_object_get_ex(inst, MSG_COUNT_KEY, &value);
+    if(inst == NULL || json_object_get_int64(value) != 0) {
+        LOGERROR("Stats not reset after the read\n");
+        json_object_put(stats_json);
+        return 1;
+    }
+    json_object_put(stats_json);
     return 0;
 }
 
@@ -539,16 +592,7 @@ int main(int argc, char** argv) {
     success = 0;
     failure = 0;
 
-    if(test_moving_average() == 0) {
-        LOGINFO("Success!\n");
-        success++;
-    } else {
-        LOGINFO("Failed\n");
-        failure++;
-    }
-    count++;
-
-    if(test_init_message_map() == 0) {
+    if(test_buckets() == 0) {
         LOGINFO("Success!\n");
         success++;
     } else {
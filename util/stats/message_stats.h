@@ -91,6 +91,10 @@
 #define MSG_COUNT_KEY "count"
 #define MSG_OK_COUNT_KEY "success_count"
 #define MSG_FAIL_COUNT_KEY "failure_count"
+#define MSG_P50_KEY "p50"
+#define MSG_P95_KEY "p95"
+#define MSG_P99_KEY "p99"
+#define MSG_P999_KEY "p999"
 #define STATS_ENABLED_KEY "enabled" //tracks state of the stats system, if disabled, stats aren't collected
 
 #define MSG_MEAN_INIT 0
@@ -98,6 +102,16 @@
 #define MSG_MAX_INIT -1
 #define MSG_COUNT_INIT 0
 
+#define MSG_STATS_MAX_MESSAGES 128 //!< distinct message types that can be tracked, the CC and NC each have fewer than 64
+#define MSG_STATS_NAME_LEN 64 //!< longest message name kept, including the terminating nul
+
+//! The latency histogram is log-bucketed like an HDR histogram: values below 2^MSG_HIST_SUB_BITS ms
+//! get a bucket each and every power of two above is split in 2^MSG_HIST_SUB_BITS linear sub-buckets,
+//! so a percentile is never off by more than 1/2^MSG_HIST_SUB_BITS (6.25%) of its value
+#define MSG_HIST_SUB_BITS 4
+#define MSG_HIST_SUB_BUCKETS (1 << MSG_HIST_SUB_BITS)
+#define MSG_HIST_BUCKETS ((32 - MSG_HIST_SUB_BITS + 1) * MSG_HIST_SUB_BUCKETS) //!< covers every 32-bit millisecond value
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -116,6 +130,27 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Statistics of one message type over the current interval. The counters are only ever
+//! updated with atomic operations, so that no lock is needed to account for a message.
+typedef struct message_stat_t {
+    volatile int used;                 //!< 0 if the slot is free, 1 while its name is being set and 2 once it is in use
+    char name[MSG_STATS_NAME_LEN];     //!< the message type, set once when the slot is claimed
+    long long count;                   //!< messages handled
+    long long ok_count;                //!< messages that succeeded
+    long long fail_count;              //!< messages that failed
+    long long total_ms;                //!< sum of the handling times, for the mean
+    long long min_ms;                  //!< shortest handling time or MSG_MIN_INIT
+    long long max_ms;                  //!< longest handling time or MSG_MAX_INIT
+    unsigned int hist[MSG_HIST_BUCKETS];    //!< handling times, see MSG_HIST_SUB_BITS
+} message_stat;
+
+//! State of the message statistics of a component. Holds no pointers, so that the CC can keep
+//! it in a memory region shared between its processes.
+typedef struct message_stats_state_t {
+    volatile int enabled;              //!< if not set, updates are ignored
+    message_stat messages[MSG_STATS_MAX_MESSAGES];  //!< open-addressed by a hash of the message name
+} message_stats_state;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -128,26 +163,29 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-//! Update stats for the message
+//! Update stats for the message. Lock-free, safe to call from any thread or process sharing the state.
 //! failed = 1 indicates the message was an error/failure
 //! failed = 0 indicates the message was a successful operation 
-int update_message_stats(json_object *stats_state, const char *message_name, int timing_ms, int failed);
+int update_message_stats(message_stats_state *stats_state, const char *message_name, long timing_ms, int failed);
 
 //Iterate through and reset all message metrics for next interval
-int reset_message_stats(json_object **stats_state);
+int reset_message_stats(message_stats_state *stats_state);
 
 //! Idempotently initialize the message sensor structures. Not threadsafe.
-int initialize_message_stats(json_object **stats_state);
+int initialize_message_stats(message_stats_state *stats_state);
 
 //! Get the full set of current message stats as a json object.
 //! Output will be a new allocated structure independent of any state internal
-//! to the stats tracking
-//! @returns json object for give state string, or NULL if error or no string given
-json_object *get_message_stats_json(const char *message_stats_string);
+//! to the stats tracking. If reset is set, the counters are zeroed as they are read.
+//! @returns json object for the given state, or NULL if error or no state given
+json_object *get_message_stats_json(message_stats_state *stats_state, int reset);
+
+//! Latency below which the given fraction (0.0 to 1.0) of the messages were handled, in ms
+long long get_message_percentile(const message_stat *msg_stat, double fraction);
 
-void enable_stats(json_object *stats_state);
-int is_enabled(json_object *stats_state);
-void disable_stats(json_object *stats_state);
+void enable_stats(message_stats_state *stats_state);
+int is_enabled(message_stats_state *stats_state);
+void disable_stats(message_stats_state *stats_state);
 
 
 /*----------------------------------------------------------------------------*\
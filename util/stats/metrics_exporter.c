@@ -0,0 +1,792 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/metrics_exporter.c
+//! Metrics endpoint. Serves the current values of the enabled internal sensors,
+//! read straight from the sensor registry, in the OpenMetrics text format over
+//! a minimal HTTP/1.0 server on a TCP port or a UNIX socket.
+//!
+//! The values of a sensor are flattened as follows, with the sensor name as the prefix
+//! of the metric families, e.g. euca.components.nc.msgs.stats for the NC message stats:
+//! \li a number or boolean becomes a gauge, e.g. euca_components_nc_msgs_stats_enabled 1
+//! \li a string becomes an info metric with the string as its value label
+//! \li a map, such as one per message type or semaphore, becomes a sample of each of its
+//!     entries labeled with the key of the map, e.g.
+//!     euca_components_nc_msgs_stats_p99{name="DescribeResource"} 12
+//! \li an array of numbers, such as a histogram, becomes a sample per element labeled with
+//!     its position in the array
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE                    // accept4
+#endif /* ! _GNU_SOURCE */
+
+#include "metrics_exporter.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <eucalyptus.h>
+#include <euca_string.h>
+#include <string.h>
+#include <hashtable.h>
+#include <log.h>
+#include <trace.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#define METRICS_NAME_MAX 256           //!< longest metric family name
+#define METRICS_LABELS_MAX 512         //!< longest label set of a sample
+#define METRICS_REQUEST_MAX 4096       //!< longest HTTP request read, the rest is ignored
+#define METRICS_IO_TIMEOUT_SEC 5       //!< on a slow or stuck client
+#define METRICS_BACKLOG 16
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A growable string
+typedef struct metrics_text_t {
+    char *data;
+    size_t len;
+    size_t size;
+} metrics_text;
+
+//! A metric family and its samples, which must be rendered together
+typedef struct metrics_family_t {
+    char name[METRICS_NAME_MAX];
+    const char *type;                  //!< "gauge" or "info"
+    metrics_text samples;
+} metrics_family;
+
+//! The families of a rendering, in the order they were first seen
+typedef struct metrics_family_set_t {
+    metrics_family *families;
+    int len;
+    int size;
+    hashtable *index;                  //!< family name to its position in families, plus one
+} metrics_family_set;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static int listen_fd = -1;
+static pthread_t listen_thread;
+static char listen_unix_path[EUCA_MAX_PATH];
+static void (*metrics_lock_fn)();
+static void (*metrics_unlock_fn)();
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int text_append(metrics_text *text, const char *format, ...) _attribute_format_(2, 3);
+static void make_metric_name(char *name, size_t size, const char *prefix, const char *key);
+static int append_label(char *labels, size_t size, const char *label_name, const char *label_value);
+static metrics_family *get_family(metrics_family_set *set, const char *name, const char *type);
+static void add_value(metrics_family_set *set, const char *name, const char *labels, json_object *value);
+static void add_sensor(metrics_family_set *set, struct internal_sensor *sensor);
+static int open_listener(const char *listen_address);
+static int send_all(int fd, const char *data, size_t len);
+static void serve_request(int fd);
+static void *listener_thread(void *arg);
+
+#ifdef _UNIT_TEST
+static int test_render_metrics();
+static int test_listener();
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Appends to the text, growing it as needed
+//! @returns EUCA_OK or EUCA_MEMORY_ERROR
+static int text_append(metrics_text *text, const char *format, ...) {
+    int len = 0;
+    size_t size = 0;
+    char *data = NULL;
+    va_list args;
+
+    for (;;) {
+        va_start(args, format);
+        len = vsnprintf(((text->data == NULL) ? NULL : (text->data + text->len)), (text->size - text->len), format, args);
+        va_end(args);
+        if (len < 0)
+            return EUCA_ERROR;
+        if ((text->data != NULL) && ((text->len + len) < text->size)) {
+            text->len += len;
+            return EUCA_OK;
+        }
+
+        for (size = ((text->size == 0) ? 1024 : text->size); size <= (text->len + len); size *= 2) ;
+        if ((data = EUCA_REALLOC(text->data, size, sizeof(char))) == NULL)
+            return EUCA_MEMORY_ERROR;
+        text->data = data;
+        text->size = size;
+    }
+}
+
+//! Joins the prefix and key with an underscore, replacing what may not be in a metric name
+static void make_metric_name(char *name, size_t size, const char *prefix, const char *key) {
+    size_t i = 0;
+
+    snprintf(name, size, "%s_%s", prefix, key);
+    for (i = 0; name[i] != '\0'; i++) {
+        if (!(((name[i] >= 'a') && (name[i] <= 'z')) || ((name[i] >= 'A') && (name[i] <= 'Z')) || (name[i] == '_') || (name[i] == ':') ||
+              ((i > 0) && (name[i] >= '0') && (name[i] <= '9')))) {
+            name[i] = '_';
+        }
+    }
+}
+
+//! Adds a label, escaped, to a comma-separated label set
+//! @returns EUCA_OK or EUCA_OVERFLOW_ERROR if the label set is full
+static int append_label(char *labels, size_t size, const char *label_name, const char *label_value) {
+    size_t len = strlen(labels);
+
+    if ((len += snprintf(labels + len, size - len, "%s%s=\"", ((len > 0) ? "," : ""), label_name)) >= size)
+        return EUCA_OVERFLOW_ERROR;
+    for (const char *c = label_value; *c != '\0'; c++) {
+        if ((len + 3) >= size)
+            return EUCA_OVERFLOW_ERROR;
+        if ((*c == '\\') || (*c == '"')) {
+            labels[len++] = '\\';
+            labels[len++] = *c;
+        } else if (*c == '\n') {
+            labels[len++] = '\\';
+            labels[len++] = 'n';
+        } else {
+            labels[len++] = *c;
+        }
+    }
+    labels[len++] = '"';
+    labels[len] = '\0';
+    return EUCA_OK;
+}
+
+//! Finds the family of the given name, adding it if it is new
+//! @returns the family or NULL if out of memory or if it exists with another type
+static metrics_family *get_family(metrics_family_set *set, const char *name, const char *type) {
+    intptr_t pos = (intptr_t) hashtable_get(set->index, name);
+    metrics_family *families = NULL;
+
+    if (pos > 0) {
+        return ((strcmp(set->families[pos - 1].type, type) == 0) ? &(set->families[pos - 1]) : NULL);
+    }
+
+    if (set->len == set->size) {
+        if ((families = EUCA_REALLOC(set->families, ((set->size == 0) ? 32 : (set->size * 2)), sizeof(metrics_family))) == NULL)
+            return NULL;
+        set->families = families;
+        set->size = ((set->size == 0) ? 32 : (set->size * 2));
+    }
+
+    if (hashtable_set(set->index, name, (void *)((intptr_t) (set->len + 1))) != EUCA_OK)
+        return NULL;
+    bzero(&(set->families[set->len]), sizeof(metrics_family));
+    euca_strncpy(set->families[set->len].name, name, METRICS_NAME_MAX);
+    set->families[set->len].type = type;
+    return &(set->families[set->len++]);
+}
+
+//! Adds the samples of a value to the family of the given name
+static void add_value(metrics_family_set *set, const char *name, const char *labels, json_object *value) {
+    int i = 0;
+    char element_labels[METRICS_LABELS_MAX] = "";
+    char label_set[METRICS_LABELS_MAX + 2] = "";
+    char position[16] = "";
+    metrics_family *family = NULL;
+
+    if (labels[0] != '\0')
+        snprintf(label_set, sizeof(label_set), "{%s}", labels);
+
+    switch (json_object_get_type(value)) {
+    case json_type_boolean:
+    case json_type_int:
+        if ((family = get_family(set, name, "gauge")) != NULL)
+            text_append(&(family->samples), "%s%s %lld\n", name, label_set, (long long)json_object_get_int64(value));
+        break;
+    case json_type_double:
+        if ((family = get_family(set, name, "gauge")) != NULL)
+            text_append(&(family->samples), "%s%s %.15g\n", name, label_set, json_object_get_double(value));
+        break;
+    case json_type_string:
+        euca_strncpy(element_labels, labels, sizeof(element_labels));
+        if ((append_label(element_labels, sizeof(element_labels), "value", json_object_get_string(value)) == EUCA_OK)
+            && ((family = get_family(set, name, "info")) != NULL)) {
+            text_append(&(family->samples), "%s_info{%s} 1\n", name, element_labels);
+        }
+        break;
+    case json_type_array:
+        for (i = 0; i < (int)json_object_array_length(value); i++) {
+            snprintf(position, sizeof(position), "%d", i);
+            euca_strncpy(element_labels, labels, sizeof(element_labels));
+            if (append_label(element_labels, sizeof(element_labels), "position", position) == EUCA_OK) {
+                add_value(set, name, element_labels, json_object_array_get_idx(value, i));
+            }
+        }
+        break;
+    default:
+        // nested maps do not map to metrics
+        break;
+    }
+}
+
+//! Adds the current values of a sensor, if it can be read without side effects
+static void add_sensor(metrics_family_set *set, struct internal_sensor *sensor) {
+    json_object *values = NULL;
+    char prefix[METRICS_NAME_MAX] = "";
+    char name[METRICS_NAME_MAX] = "";
+    char labels[METRICS_LABELS_MAX] = "";
+
+    if ((sensor->values_function == NULL) || ((values = sensor->values_function()) == NULL))
+        return;
+
+    make_metric_name(prefix, sizeof(prefix), sensor->sensor_name, "");
+    prefix[strlen(prefix) - 1] = '\0';
+
+    if (json_object_is_type(values, json_type_object)) {
+        json_object_object_foreach(values, key, value) {
+            if (json_object_is_type(value, json_type_object)) {
+                labels[0] = '\0';
+                if (append_label(labels, sizeof(labels), "name", key) != EUCA_OK)
+                    continue;
+                json_object_object_foreach(value, field, field_value) {
+                    make_metric_name(name, sizeof(name), prefix, field);
+                    add_value(set, name, labels, field_value);
+                }
+            } else {
+                make_metric_name(name, sizeof(name), prefix, key);
+                add_value(set, name, "", value);
+            }
+        }
+    }
+    json_object_put(values);
+}
+
+//! Renders the enabled sensors that can be read without side effects, grouping the samples
+//! of each metric family as OpenMetrics requires
+//! @returns EUCA_OK, with the text in *out, or an error code
+int render_metrics(struct internal_sensor **sensors, int sensor_count, char **out, size_t *out_len) {
+    int i = 0;
+    int ret = EUCA_OK;
+    metrics_text text = { 0 };
+    metrics_family_set set = { 0 };
+
+    if ((out == NULL) || ((sensor_count > 0) && (sensors == NULL)))
+        return EUCA_INVALID_ERROR;
+    if ((set.index = hashtable_create(64)) == NULL)
+        return EUCA_MEMORY_ERROR;
+
+    for (i = 0; i < sensor_count; i++) {
+        if (sensors[i]->enabled) {
+            add_sensor(&set, sensors[i]);
+        }
+    }
+
+    for (i = 0; (i < set.len) && (ret == EUCA_OK); i++) {
+        if ((ret = text_append(&text, "# TYPE %s %s\n", set.families[i].name, set.families[i].type)) == EUCA_OK)
+            ret = text_append(&text, "%s", ((set.families[i].samples.data == NULL) ? "" : set.families[i].samples.data));
+    }
+    if (ret == EUCA_OK)
+        ret = text_append(&text, "# EOF\n");
+
+    for (i = 0; i < set.len; i++) {
+        EUCA_FREE(set.families[i].samples.data);
+    }
+    EUCA_FREE(set.families);
+    hashtable_free(set.index);
+
+    if (ret != EUCA_OK) {
+        EUCA_FREE(text.data);
+        return ret;
+    }
+    *out = text.data;
+    if (out_len != NULL)
+        *out_len = text.len;
+    return EUCA_OK;
+}
+
+//! Binds the listening socket: METRICS_UNIX_PREFIX followed by a path, host:port or just a port
+//! @returns the socket or -1 on error
+static int open_listener(const char *listen_address) {
+    int fd = -1;
+    int one = 1;
+    int rc = 0;
+    char host[EUCA_MAX_PATH] = METRICS_DEFAULT_HOST;
+    char *port = NULL;
+    struct sockaddr_un sun = { 0 };
+    struct addrinfo hints = { 0 };
+    struct addrinfo *addrs = NULL;
+
+    if (!strncmp(listen_address, METRICS_UNIX_PREFIX, strlen(METRICS_UNIX_PREFIX))) {
+        euca_strncpy(listen_unix_path, listen_address + strlen(METRICS_UNIX_PREFIX), sizeof(listen_unix_path));
+        if ((strlen(listen_unix_path) == 0) || (strlen(listen_unix_path) >= sizeof(sun.sun_path))) {
+            LOGERROR("invalid metrics socket path '%s'\n", listen_unix_path);
+            return -1;
+        }
+        sun.sun_family = AF_UNIX;
+        euca_strncpy(sun.sun_path, listen_unix_path, sizeof(sun.sun_path));
+        unlink(listen_unix_path);      // left over by a previous run
+        if (((fd = socket(AF_UNIX, (SOCK_STREAM | SOCK_CLOEXEC), 0)) < 0) || (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)) {
+            LOGERROR("cannot bind metrics socket %s: %s\n", listen_unix_path, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            listen_unix_path[0] = '\0';
+            return -1;
+        }
+    } else {
+        if ((port = strrchr(listen_address, ':')) != NULL) {
+            snprintf(host, sizeof(host), "%.*s", (int)(port - listen_address), listen_address);
+            port++;
+        } else {
+            port = (char *)listen_address;
+        }
+
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        if ((rc = getaddrinfo(((strlen(host) > 0) ? host : NULL), port, &hints, &addrs)) != 0) {
+            LOGERROR("invalid metrics listen address '%s': %s\n", listen_address, gai_strerror(rc));
+            return -1;
+        }
+        if ((fd = socket(addrs->ai_family, (SOCK_STREAM | SOCK_CLOEXEC), 0)) >= 0) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, addrs->ai_addr, addrs->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addrs);
+        if (fd < 0) {
+            LOGERROR("cannot bind metrics listen address '%s': %s\n", listen_address, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (listen(fd, METRICS_BACKLOG) != 0) {
+        LOGERROR("cannot listen on metrics address '%s': %s\n", listen_address, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//! Writes all of the data, without raising SIGPIPE if the client went away
+static int send_all(int fd, const char *data, size_t len) {
+    ssize_t sent = 0;
+
+    while (len > 0) {
+        if ((sent = send(fd, data, len, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return EUCA_ERROR;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return EUCA_OK;
+}
+
+//! Answers one HTTP request: GET or HEAD of / or /metrics, or of /traces for the tracing spans
+static void serve_request(int fd) {
+    int head = FALSE;
+    int status = 200;
+    const char *content_type = METRICS_CONTENT_TYPE;
+    char request[METRICS_REQUEST_MAX] = "";
+    char header[256] = "";
+    char *path = NULL;
+    char *body = NULL;
+    size_t body_len = 0;
+    size_t len = 0;
+    ssize_t got = 0;
+    struct timeval timeout = { METRICS_IO_TIMEOUT_SEC, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while ((len < (sizeof(request) - 1)) && !strstr(request, "\r\n\r\n") && !strstr(request, "\n\n")) {
+        if ((got = recv(fd, request + len, (sizeof(request) - 1 - len), 0)) <= 0) {
+            if ((got < 0) && (errno == EINTR))
+                continue;
+            break;
+        }
+        len += got;
+        request[len] = '\0';
+    }
+
+    if (!strncmp(request, "GET ", 4)) {
+        path = request + 4;
+    } else if (!strncmp(request, "HEAD ", 5)) {
+        path = request + 5;
+        head = TRUE;
+    } else {
+        status = 405;
+    }
+
+    if (path != NULL) {
+        path[strcspn(path, " ?\r\n")] = '\0';
+        if (!strcmp(path, TRACES_PATH)) {
+            content_type = TRACES_CONTENT_TYPE;
+            if (trace_get_ring() == NULL) {
+                status = 404;
+            } else if (trace_export_zipkin(trace_get_ring(), &body, &body_len) != EUCA_OK) {
+                status = 500;
+            }
+        } else if (strcmp(path, "/") && strcmp(path, "/metrics")) {
+            status = 404;
+        } else {
+            if (metrics_lock_fn != NULL)
+                metrics_lock_fn();
+            if (render_metrics(sensor_registry.sensors, sensor_registry.sensor_count, &body, &body_len) != EUCA_OK)
+                status = 500;
+            if (metrics_unlock_fn != NULL)
+                metrics_unlock_fn();
+        }
+    }
+
+    snprintf(header, sizeof(header), "HTTP/1.0 %d %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n", status,
+             ((status == 200) ? "OK" : ((status == 404) ? "Not Found" : ((status == 405) ? "Method Not Allowed" : "Internal Server Error"))),
+             ((status == 200) ? content_type : "text/plain"), (unsigned long)((status == 200) ? body_len : 0));
+    if ((send_all(fd, header, strlen(header)) == EUCA_OK) && (status == 200) && !head) {
+        send_all(fd, body, body_len);
+    }
+    EUCA_FREE(body);
+}
+
+//! Serves the requests one at a time, scrapes being infrequent, until the socket is shut down
+static void *listener_thread(void *arg) {
+    int fd = -1;
+    int listener = (int)((intptr_t) arg);
+
+    for (;;) {
+        if ((fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EMFILE) || (errno == ENFILE))
+                continue;
+            break;
+        }
+        serve_request(fd);
+        close(fd);
+    }
+    LOGDEBUG("metrics listener exiting\n");
+    return NULL;
+}
+
+//! The lock functions are those that guard the sensors during a pass; they are
+//! held while the metrics are rendered
+//! @returns EUCA_OK or an error code
+int start_metrics_listener(const char *listen_address, void (*lock_fn)(), void (*unlock_fn)()) {
+    if ((listen_address == NULL) || (strlen(listen_address) == 0)) {
+        return EUCA_INVALID_ERROR;
+    }
+    if (listen_fd >= 0) {
+        LOGDEBUG("metrics listener already started\n");
+        return EUCA_OK;
+    }
+
+    if ((listen_fd = open_listener(listen_address)) < 0) {
+        return EUCA_ERROR;
+    }
+
+    metrics_lock_fn = lock_fn;
+    metrics_unlock_fn = unlock_fn;
+    if (pthread_create(&listen_thread, NULL, listener_thread, (void *)((intptr_t) listen_fd)) != 0) {
+        LOGERROR("cannot start the metrics listener thread\n");
+        stop_metrics_listener();
+        return EUCA_THREAD_ERROR;
+    }
+    LOGINFO("serving metrics on %s\n", listen_address);
+    return EUCA_OK;
+}
+
+//! Shutting down the listening socket wakes up the thread in accept()
+void stop_metrics_listener() {
+    if (listen_fd < 0) {
+        return;
+    }
+
+    shutdown(listen_fd, SHUT_RDWR);
+    if (listen_thread) {
+        pthread_join(listen_thread, NULL);
+        listen_thread = 0;
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    if (listen_unix_path[0] != '\0') {
+        unlink(listen_unix_path);
+        listen_unix_path[0] = '\0';
+    }
+}
+
+#ifdef _UNIT_TEST
+static json_object *test_msg_values() {
+    json_object *values = json_object_new_object();
+    json_object *msg = json_object_new_object();
+    json_object *hist = json_object_new_array();
+
+    json_object_array_add(hist, json_object_new_int64(3));
+    json_object_array_add(hist, json_object_new_int64(4));
+    json_object_object_add(msg, "count", json_object_new_int64(7));
+    json_object_object_add(msg, "mean", json_object_new_double(12.5));
+    json_object_object_add(msg, "histogram", hist);
+    json_object_object_add(values, "enabled", json_object_new_boolean(TRUE));
+    json_object_object_add(values, "run\"Instance", msg);
+    return values;
+}
+
+static json_object *test_state_values() {
+    json_object *values = json_object_new_object();
+    json_object_object_add(values, "state", json_object_new_string("ENABLED"));
+    return values;
+}
+
+static struct internal_sensor test_sensors[2];
+
+static void test_init_sensors() {
+    struct internal_sensor *sensors[] = { &test_sensors[0], &test_sensors[1] };
+
+    bzero(test_sensors, sizeof(test_sensors));
+    euca_strncpy(test_sensors[0].sensor_name, "euca.components.nc.msgs.stats", SENSOR_NAME_MAX);
+    test_sensors[0].enabled = 1;
+    test_sensors[0].values_function = test_msg_values;
+    euca_strncpy(test_sensors[1].sensor_name, "euca.components.nc.service.state", SENSOR_NAME_MAX);
+    test_sensors[1].enabled = 1;
+    test_sensors[1].values_function = test_state_values;
+
+    sensor_registry.sensor_count = 2;
+    memcpy(sensor_registry.sensors, sensors, sizeof(sensors));
+}
+
+static int test_render_metrics() {
+    int ret = 0;
+    char *text = NULL;
+    size_t len = 0;
+    const char *expected =
+        "# TYPE euca_components_nc_msgs_stats_enabled gauge\n"
+        "euca_components_nc_msgs_stats_enabled 1\n"
+        "# TYPE euca_components_nc_msgs_stats_count gauge\n"
+        "euca_components_nc_msgs_stats_count{name=\"run\\\"Instance\"} 7\n"
+        "# TYPE euca_components_nc_msgs_stats_mean gauge\n"
+        "euca_components_nc_msgs_stats_mean{name=\"run\\\"Instance\"} 12.5\n"
+        "# TYPE euca_components_nc_msgs_stats_histogram gauge\n"
+        "euca_components_nc_msgs_stats_histogram{name=\"run\\\"Instance\",position=\"0\"} 3\n"
+        "euca_components_nc_msgs_stats_histogram{name=\"run\\\"Instance\",position=\"1\"} 4\n"
+        "# TYPE euca_components_nc_service_state_state info\n"
+        "euca_components_nc_service_state_state_info{value=\"ENABLED\"} 1\n"
+        "# EOF\n";
+
+    LOGINFO("Testing metrics rendering\n");
+    test_init_sensors();
+    if (render_metrics(sensor_registry.sensors, sensor_registry.sensor_count, &text, &len) != EUCA_OK) {
+        LOGERROR("rendering failed\n");
+        return 1;
+    }
+    LOGINFO("Rendered:\n%s", text);
+    if ((len != strlen(expected)) || strcmp(text, expected)) {
+        LOGERROR("unexpected rendering, expected:\n%s", expected);
+        ret = 1;
+    }
+    EUCA_FREE(text);
+
+    //Disabled sensors are left out
+    test_sensors[0].enabled = 0;
+    render_metrics(sensor_registry.sensors, sensor_registry.sensor_count, &text, &len);
+    if (strstr(text, "msgs_stats") != NULL) {
+        LOGERROR("disabled sensor rendered\n");
+        ret = 1;
+    }
+    EUCA_FREE(text);
+    return ret;
+}
+
+static int test_listener() {
+    int fd = -1;
+    int ret = 1;
+    ssize_t got = 0;
+    size_t len = 0;
+    char response[8192] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char address[EUCA_MAX_PATH + sizeof(METRICS_UNIX_PREFIX)] = "";
+    struct sockaddr_un sun = { 0 };
+    const char *request = "GET /metrics HTTP/1.0\r\nHost: localhost\r\n\r\n";
+
+    LOGINFO("Testing metrics listener\n");
+    test_init_sensors();
+    snprintf(path, sizeof(path), "/tmp/euca-metrics-test-%d.sock", getpid());
+    snprintf(address, sizeof(address), "%s%s", METRICS_UNIX_PREFIX, path);
+    if (start_metrics_listener(address, NULL, NULL) != EUCA_OK) {
+        LOGERROR("cannot start the listener\n");
+        return 1;
+    }
+
+    sun.sun_family = AF_UNIX;
+    euca_strncpy(sun.sun_path, path, sizeof(sun.sun_path));
+    if (((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0) && (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) == 0)
+        && (send_all(fd, request, strlen(request)) == EUCA_OK)) {
+        while ((len < (sizeof(response) - 1)) && ((got = read(fd, response + len, sizeof(response) - 1 - len)) > 0))
+            len += got;
+        response[len] = '\0';
+        LOGINFO("Response:\n%s", response);
+        if (!strncmp(response, "HTTP/1.0 200 OK", 15) && strstr(response, METRICS_CONTENT_TYPE) && strstr(response, "\r\n\r\n# TYPE ")
+            && strstr(response, "# EOF\n")) {
+            ret = 0;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    stop_metrics_listener();
+    if (access(path, F_OK) == 0) {
+        LOGERROR("socket left behind\n");
+        ret = 1;
+    }
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if (test_render_metrics() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    if (test_listener() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return 0;
+}
+#endif
@@ -0,0 +1,295 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/qos_sensor.c
+//! QoS sensor, reporting the disk and network caps of the instances and whether the
+//! hypervisor enforces them. The entries come from a function of the component.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "qos_sensor.h"
+#include "sensor_common.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <eucalyptus.h>
+#include <euca_string.h>
+#include <euca_alloc.h>
+#include <string.h>
+#include <log.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static int qos_sensor_ttl = 0;
+static char interval_tag[SENSOR_TAG_MAX];
+static int (*qos_get)(qos_sensor_entry ** entries, int *entries_len) = NULL;   //!< function of the component getting the entries
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static json_object *qos_sensor_values_call();
+
+#ifdef _UNIT_TEST
+static int test_qos_get(qos_sensor_entry ** entries, int *entries_len);
+static int test_qos_sensor();
+
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Gets the caps of the instances, keyed by instance identifier, and the number of
+//! instances whose caps are and are not enforced.
+static json_object *qos_sensor_values_call() {
+    int entries_len = 0;
+    int enforced = 0;
+    qos_sensor_entry *entries = NULL;
+    json_object *qos_data;
+    json_object *instances_data;
+    json_object *entry;
+
+    if ((qos_get == NULL) || (qos_get(&entries, &entries_len) != EUCA_OK)) {
+        LOGERROR("Failed to get QoS state of the instances\n");
+        return NULL;
+    }
+
+    instances_data = json_object_new_object();
+    for (int i = 0; i < entries_len; i++) {
+        entry = json_object_new_object();
+        json_object_object_add(entry, "vm_type", json_object_new_string(entries[i].vm_type));
+        json_object_object_add(entry, "disk_iops", json_object_new_int64(entries[i].disk_iops));
+        json_object_object_add(entry, "disk_bytes_per_sec", json_object_new_int64(entries[i].disk_bytes));
+        json_object_object_add(entry, "net_in_kb_per_sec", json_object_new_int64(entries[i].net_in_kbs));
+        json_object_object_add(entry, "net_out_kb_per_sec", json_object_new_int64(entries[i].net_out_kbs));
+        json_object_object_add(entry, "enforced", json_object_new_boolean(entries[i].enforced));
+        json_object_object_add(instances_data, entries[i].instance_id, entry);
+        if (entries[i].enforced)
+            enforced++;
+    }
+    EUCA_FREE(entries);
+
+    qos_data = json_object_new_object();
+    json_object_object_add(qos_data, "instances", instances_data);
+    json_object_object_add(qos_data, "enforced", json_object_new_int(enforced));
+    json_object_object_add(qos_data, "not_enforced", json_object_new_int(entries_len - enforced));
+    return qos_data;
+}
+
+//! Entry point for the QoS sensor
+json_object *qos_sensor_call() {
+    json_object *qos_data;
+    json_object *event_json;
+    json_object *tags;
+
+    if ((qos_data = qos_sensor_values_call()) == NULL) {
+        return NULL;
+    }
+
+    tags = build_tag_set(1, interval_tag);
+    //The output gets its own copy of the values
+    event_json = build_sensor_output(qos_sensor.sensor_name, QOS_SENSOR_DESCRIPTION, time(NULL), qos_sensor_ttl, tags, qos_data);
+    json_object_put(qos_data);
+
+    if(event_json == NULL) {
+        LOGERROR("Failed in QoS stats output generation.");
+        return NULL;
+    }
+
+    return event_json;
+}
+
+//! Idempotently initialize the QoS sensor structures. Not threadsafe.
+//! The function qos_get_fn() sets an array of entries allocated with EUCA_ALLOC(),
+//! which the sensor frees.
+int initialize_qos_sensor(const char *service_name, int interval, int event_ttl, int (*qos_get_fn)(qos_sensor_entry ** entries, int *entries_len)) {
+    if(service_name == NULL || event_ttl < 0 || qos_get_fn == NULL) {
+        LOGERROR("Invalid initialization values for QoS sensor. Cannot initialize\n");
+        return EUCA_ERROR;
+    }
+
+    LOGINFO("Initializing QoS sensor for component %s\n", service_name);
+    euca_strncpy(qos_sensor.config_name, QOS_SENSOR_NAME, SENSOR_NAME_MAX);
+    snprintf(qos_sensor.sensor_name, SENSOR_NAME_MAX, QOS_SENSOR_NAME_FORMAT, service_name);
+    qos_sensor.enabled = 0;
+    qos_sensor.sensor_function = qos_sensor_call;
+    qos_sensor.state_toggle_callback = NULL;
+    qos_sensor.values_function = qos_sensor_values_call;
+
+    qos_get = qos_get_fn;
+    qos_sensor_ttl = event_ttl;
+    snprintf(interval_tag, SENSOR_TAG_MAX, SENSOR_INTERVAL_PERIOD_TAG_FORMAT, interval);
+
+    return EUCA_OK;
+}
+
+#ifdef _UNIT_TEST
+
+static int test_qos_get(qos_sensor_entry ** entries, int *entries_len) {
+    if ((*entries = EUCA_ZALLOC(2, sizeof(qos_sensor_entry))) == NULL) {
+        return EUCA_MEMORY_ERROR;
+    }
+
+    euca_strncpy((*entries)[0].instance_id, "i-12345678", sizeof((*entries)[0].instance_id));
+    euca_strncpy((*entries)[0].vm_type, "m1.small", sizeof((*entries)[0].vm_type));
+    (*entries)[0].disk_iops = 500;
+    (*entries)[0].net_in_kbs = 1000;
+    (*entries)[0].enforced = 1;
+    euca_strncpy((*entries)[1].instance_id, "i-87654321", sizeof((*entries)[1].instance_id));
+    euca_strncpy((*entries)[1].vm_type, "c1.medium", sizeof((*entries)[1].vm_type));
+    (*entries)[1].disk_bytes = 1048576;
+    *entries_len = 2;
+    return EUCA_OK;
+}
+
+int test_qos_sensor() {
+    int test_ttl = 60;
+    json_object *event = NULL;
+
+    initialize_qos_sensor("nc", test_ttl, test_ttl, test_qos_get);
+    if ((event = qos_sensor_call()) == NULL) {
+        return 1;
+    }
+    LOGINFO("Result map: %s\n", json_object_to_json_string_ext(event, JSON_C_TO_STRING_PRETTY));
+    json_object_put(event);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if(test_qos_sensor() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return 0;
+}
+#endif
+}
+#endif
@@ -124,6 +124,7 @@ struct internal_sensor {
     int ttl; //Time result is valid    
     json_object* (*sensor_function)(); //Function pointer to get result
     void (*state_toggle_callback)(int enabled); //Function called when the enable/disable is changed. May be NULL in which case no call is made
+    json_object* (*values_function)(); //Function to get the current values, without the event wrapper and without resetting them, for the metrics endpoint. May be NULL
 };
 
 /*----------------------------------------------------------------------------*\
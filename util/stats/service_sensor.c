@@ -131,6 +131,8 @@ static char interval_tag[SENSOR_TAG_MAX];
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static json_object *service_state_values_call();
+
 #ifdef _UNIT_TEST
 static int test_service_state_sensor();
 
@@ -148,13 +150,9 @@ static int test_service_state_sensor();
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-//! Entry point for the message stats sensor. Gets the stats data from
-//! the message maps and sends it to the emitter.
-//! The arg is a string for the service name to use in output.
-json_object *service_state_sensor_call() {
+//! Current service state and check result
+static json_object *service_state_values_call() {
     json_object *msg_data;
-    json_object *event_json;
-    json_object *tags;
 
     char *service_state = internal_state_sensor.state_callback();
     char *check_result = internal_state_sensor.check_callback();
@@ -162,6 +160,18 @@ json_object *service_state_sensor_call() {
     msg_data = json_object_new_object();
     json_object_object_add(msg_data, SERVICE_STATE_KEY, json_object_new_string(service_state));
     json_object_object_add(msg_data, SERVICE_CHECK_KEY, json_object_new_string(check_result));
+    return msg_data;
+}
+
+//! Entry point for the message stats sensor. Gets the stats data from
+//! the message maps and sends it to the emitter.
+//! The arg is a string for the service name to use in output.
+json_object *service_state_sensor_call() {
+    json_object *msg_data;
+    json_object *event_json;
+    json_object *tags;
+
+    msg_data = service_state_values_call();
 
     tags = build_tag_set(1, interval_tag);
     event_json = build_sensor_output(service_state_sensor.sensor_name, SERVICE_STATE_SENSOR_DESCRIPTION, time(NULL), internal_state_sensor.event_ttl, tags, msg_data);
@@ -191,6 +201,7 @@ int initialize_service_state_sensor(const char *service_name, int interval, int
     service_state_sensor.enabled = 0;
     service_state_sensor.sensor_function = service_state_sensor_call;
     service_state_sensor.state_toggle_callback = NULL;
+    service_state_sensor.values_function = service_state_values_call;
 
     euca_strncpy(internal_state_sensor.service_name, service_name, SENSOR_NAME_MAX);
     internal_state_sensor.check_callback = check_call;
@@ -85,6 +85,7 @@
 #include "stats.h"
 #include "message_sensor.h"
 #include "message_stats.h"
+#include "metrics_exporter.h"
 #include "service_sensor.h"
 #include "fs_emitter.h"
 
@@ -121,6 +122,10 @@
 \*----------------------------------------------------------------------------*/
 extern struct internal_sensor message_sensor; //from message_sensor.h
 extern struct internal_sensor service_state_sensor; //from service_sensor.h
+extern struct internal_sensor lock_sensor; //from lock_sensor.h
+extern struct internal_sensor alloc_sensor; //from alloc_sensor.h
+extern struct internal_sensor command_sensor; //from command_sensor.h
+extern struct internal_sensor qos_sensor; //from qos_sensor.h
 
 /* Should preferably be handled in header file */
 
@@ -130,7 +135,7 @@ extern struct internal_sensor service_state_sensor; //from service_sensor.h
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 #ifdef _UNIT_TEST
-json_object *test_msg_stats; //Stats obj for testing
+message_stats_state test_msg_stats; //Stats obj for testing
 configEntry configEntryKeysRestart[] = { { "placeholderkey", "placeholderdefault" } }; //Not used but must have something here, cannot be zero
 configEntry configEntryKeysNoRestart[] = { {SENSOR_LIST_CONF_PARAM_NAME, SENSOR_LIST_CONF_PARAM_DEFAULT} };
 #endif
@@ -156,13 +161,14 @@ static int register_sensor_set();
 static int register_sensor(struct internal_sensor *sensor_to_register);
 static int is_registered_sensor_name(const char *name);
 static int get_new_config_status(const char *sensor_name, const char **enabled_sensors);
+static void start_metrics_endpoint();
 
 #ifdef _UNIT_TEST
 static int test_sensor_registration();
 static int test_stats_run(const char *config_file);
 static char *testing_service_state_call();
 static char *testing_service_state_call();
-static json_object **test_get_msg_stats();
+static message_stats_state *test_get_msg_stats();
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -185,10 +191,15 @@ int run_stats(int run_once, int execution_interval_sec, int (*update_config_fn)(
     useconds_t start_time_us = 0;
     useconds_t execution_interval_us = execution_interval_sec * 1000 * 1000;
     useconds_t sleep_time_us = execution_interval_us;
+
+    if(!run_once) {
+        start_metrics_endpoint();
+    }
+
     do {
         LOGTRACE("Sleeping for %d usec for next pass\n", sleep_time_us);
         usleep(sleep_time_us);
-        start_time_us = time_usec();
+        start_time_us = mono_time_usec();
 
         //update config
         if(update_config_fn) {
@@ -206,13 +217,27 @@ int run_stats(int run_once, int execution_interval_sec, int (*update_config_fn)(
             LOGTRACE("Internal stats sensor pass completed successfully\n");
         }
         
-        sleep_time_us = execution_interval_us - (time_usec() - start_time_us);
+        sleep_time_us = execution_interval_us - (mono_time_usec() - start_time_us);
     } while(!run_once);
 
     LOGDEBUG("Returning from run_stats()\n");
     return EUCA_OK;
 }
 
+//! Serves the registered sensors on the metrics endpoint set in the configuration, if any.
+//! The endpoint lives as long as the process running the stats loop.
+static void start_metrics_endpoint() {
+    char *listen_address = configFileValue(METRICS_LISTEN_CONF_PARAM_NAME);
+    if(listen_address != NULL && strlen(listen_address) > 0) {
+        if(start_metrics_listener(listen_address, get_lock_fn, release_lock_fn) != EUCA_OK) {
+            LOGERROR("Cannot serve metrics on %s\n", listen_address);
+        }
+    } else {
+        LOGDEBUG("%s not set, not serving metrics\n", METRICS_LISTEN_CONF_PARAM_NAME);
+    }
+    EUCA_FREE(listen_address);
+}
+
 //! A single sensor pass. Runs each sensor and emits the result using
 //! the configured emitter.
 //! 
@@ -289,6 +314,12 @@ int internal_sensor_pass(int return_on_fail) {
     }
     
  cleanup:
+    //The events of a pass are written together
+    if(emitter_flush() != EUCA_OK) {
+        LOGERROR("Error writing the events of the internal sensor pass\n");
+        ret = EUCA_ERROR;
+    }
+
     if(release_lock_fn != NULL) {
         release_lock_fn();
         LOGTRACE("Released lock for stats during sensor pass\n");
@@ -330,6 +361,38 @@ static int register_sensor_set() {
         LOGERROR("Error registering service state sensor\n");
     }
 
+    //only components that registered semaphores initialize the lock sensor
+    if(strlen(lock_sensor.sensor_name) > 0) {
+        LOGDEBUG("Registering lock sensor\n");
+        if(result += register_sensor(&lock_sensor) > 0) {
+            LOGERROR("Error registering lock sensor\n");
+        }
+    }
+
+    //only components built with allocation tracking initialize the allocation sensor
+    if(strlen(alloc_sensor.sensor_name) > 0) {
+        LOGDEBUG("Registering allocation sensor\n");
+        if(result += register_sensor(&alloc_sensor) > 0) {
+            LOGERROR("Error registering allocation sensor\n");
+        }
+    }
+
+    //only the NC initializes the helper command sensor, as it runs most of the helpers
+    if(strlen(command_sensor.sensor_name) > 0) {
+        LOGDEBUG("Registering helper command sensor\n");
+        if(result += register_sensor(&command_sensor) > 0) {
+            LOGERROR("Error registering helper command sensor\n");
+        }
+    }
+
+    //only the NC initializes the QoS sensor
+    if(strlen(qos_sensor.sensor_name) > 0) {
+        LOGDEBUG("Registering QoS sensor\n");
+        if(result += register_sensor(&qos_sensor) > 0) {
+            LOGERROR("Error registering QoS sensor\n");
+        }
+    }
+
     return result;
 }
 
@@ -557,14 +620,10 @@ int flush_sensor_registry() {
 
 //! ***********UNIT TESTS ****************
 #ifdef _UNIT_TEST
-static json_object **test_get_msg_stats() {
+static message_stats_state *test_get_msg_stats() {
     return &test_msg_stats;
 }
 
-static void test_set_msg_stats() {
-    return;
-}
-
 void print_header(const char* name) {
     LOGINFO("\n\n***** Running test %s *****\n", name);
 }
@@ -612,7 +671,7 @@ static int test_stats_run(const char *config_file_path) {
     LOGDEBUG("Done with config file checks\n");
 
     flush_sensor_registry(); //just to be sure from other tests
-    initialize_message_sensor("testservice", 60, 60, test_get_msg_stats, test_set_msg_stats);
+    initialize_message_sensor("testservice", 60, 60, test_get_msg_stats);
     initialize_service_state_sensor("testservice", 60, 60, state_call, check_call);
 
     if(init_stats(test_home, "testservice", test_lock, test_unlock) != EUCA_OK) {
@@ -623,9 +682,9 @@ static int test_stats_run(const char *config_file_path) {
 
     LOGINFO("Setting some message stats and doing an internal run\n");
     //populate some stats for the message stats
-    update_message_stats(test_msg_stats, "fakemessage", 500, 0);
-    update_message_stats(test_msg_stats, "fakemessageDescribe", 250, 0);
-    update_message_stats(test_msg_stats, "fakemessageRun", 200, 0);
+    update_message_stats(&test_msg_stats, "fakemessage", 500, 0);
+    update_message_stats(&test_msg_stats, "fakemessageDescribe", 250, 0);
+    update_message_stats(&test_msg_stats, "fakemessageRun", 200, 0);
 
     int ret = internal_sensor_pass(TRUE);
     flush_sensor_registry();
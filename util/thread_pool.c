@@ -0,0 +1,739 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/thread_pool.c
+//! Pool of worker threads with per-worker task queues and futures, see thread_pool.h
+//!
+//! A task submitted by a thread outside of the pool goes to the queue of submissions from
+//! outside, one submitted by a task goes to the queue of the worker running it. A worker takes
+//! the newest task of its own queue first, then the oldest submission from outside, then the
+//! oldest task of another worker, so the tasks spawned by a task tend to run on the worker that
+//! spawned them while idle workers share the load. Idle workers sleep on a counting semaphore
+//! that every submission raises.
+//!
+//! A worker waiting on a future runs the tasks of its own queue, which are all tasks that the
+//! tasks running on it spawned, while it waits. It never runs tasks from elsewhere, which may
+//! need what the tasks it is in the middle of hold, so tasks can wait on the tasks they spawn
+//! without running out of workers.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "eucalyptus.h"
+#include "misc.h"
+#include "euca_string.h"
+#include "log.h"
+#include "ipc.h"
+#include "thread_pool.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Life of a task
+typedef enum thread_pool_task_state_t {
+    TASK_QUEUED = 0,                   //!< waiting in a queue for a worker or for a thread waiting on it
+    TASK_RUNNING,                      //!< taken by the thread running it
+    TASK_DONE,                         //!< finished, with its result set
+} thread_pool_task_state;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A task, which is also the future of its result
+struct thread_pool_task_t {
+    thread_pool_fn fn;                 //!< the function to run
+    void *arg;                         //!< its argument
+    void *result;                      //!< what it returned, once the task is done
+    thread_pool *pool;                 //!< the pool the task was submitted to
+    volatile int state;                //!< one of thread_pool_task_state, which changes to TASK_RUNNING only by compare-and-swap
+    int refs;                          //!< one for the queue and one for the future, the task is freed once both are dropped
+};
+
+//! Queue of tasks, which its owner takes from the newest end and others from the oldest
+typedef struct thread_pool_queue_t {
+    pthread_mutex_t mutex;             //!< guards the fields below
+    thread_pool_future **tasks;        //!< circular array of the tasks
+    int size;                          //!< number of slots in the array
+    int head;                          //!< slot of the oldest task
+    int count;                         //!< number of tasks in the queue
+} thread_pool_queue;
+
+//! A worker thread
+typedef struct thread_pool_worker_t {
+    thread_pool *pool;                 //!< the pool the worker belongs to
+    pthread_t thread;
+    int index;                         //!< position in the workers of the pool
+    thread_pool_queue queue;           //!< tasks submitted by the tasks the worker runs
+} thread_pool_worker;
+
+//! A pool of workers
+struct thread_pool_t {
+    char name[64];                     //!< the name of the pool, for logging
+    int num_workers;                   //!< number of workers started
+    int max_workers;                   //!< number of workers allocated
+    thread_pool_worker *workers;       //!< array of the workers
+    thread_pool_queue injected;        //!< tasks submitted by threads outside of the pool
+    sem *wakeup;                       //!< raised on every submission, idle workers wait on it
+    int stopping;                      //!< set atomically by thread_pool_destroy(), workers exit once they find no task
+    volatile long long queued;         //!< tasks in all the queues, including those taken back by their waiters
+    pthread_mutex_t done_mutex;        //!< guards the switch of tasks to TASK_DONE
+    pthread_cond_t done_cond;          //!< signaled when a task is done
+    thread_pool_stats stats;           //!< updated atomically
+};
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static __thread thread_pool_worker *current_worker = NULL; //!< the worker this thread is, if it is one
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static int queue_push(thread_pool * pool, thread_pool_queue * queue, thread_pool_future * task);
+static thread_pool_future *queue_pop(thread_pool * pool, thread_pool_queue * queue, boolean newest);
+static thread_pool_future *take_task(thread_pool_worker * worker);
+static void finish_task(thread_pool_future * task, void *result);
+static boolean task_is_done(thread_pool_future * task);
+static void release_task(thread_pool_future * task);
+static void run_task(thread_pool_future * task, boolean timed);
+static void *worker_thread(void *arg);
+
+#ifdef _UNIT_TEST
+int main(int argc, char **argv);
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Starts a pool of worker threads
+//!
+//! @param[in] name the name of the pool, for logging
+//! @param[in] workers the number of worker threads, from 1 to THREAD_POOL_MAX_WORKERS
+//!
+//! @return the pool, to be stopped with thread_pool_destroy(), or NULL if not even one worker
+//!         could be started
+//!
+thread_pool *thread_pool_create(const char *name, int workers)
+{
+    int i = 0;
+    thread_pool *pool = NULL;
+
+    if ((workers < 1) || (workers > THREAD_POOL_MAX_WORKERS))
+        return (NULL);
+
+    if ((pool = EUCA_ZALLOC(1, sizeof(thread_pool))) == NULL)
+        return (NULL);
+
+    if (((pool->workers = EUCA_ZALLOC(workers, sizeof(thread_pool_worker))) == NULL) || ((pool->wakeup = sem_alloc(0, IPC_MUTEX_SEMAPHORE)) == NULL)) {
+        EUCA_FREE(pool->workers);
+        EUCA_FREE(pool);
+        return (NULL);
+    }
+
+    euca_strncpy(pool->name, ((name != NULL) ? name : "pool"), sizeof(pool->name));
+    pool->max_workers = workers;
+    pthread_mutex_init(&(pool->injected.mutex), NULL);
+    pthread_mutex_init(&(pool->done_mutex), NULL);
+    pthread_cond_init(&(pool->done_cond), NULL);
+    for (i = 0; i < workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&(pool->workers[i].queue.mutex), NULL);
+    }
+
+    for (i = 0; i < workers; i++) {
+        if (pthread_create(&(pool->workers[i].thread), NULL, worker_thread, &(pool->workers[i])) != 0) {
+            LOGWARN("failed to start worker %d of pool %s\n", i, pool->name);
+            break;
+        }
+        pool->num_workers = pool->stats.workers = (i + 1);
+    }
+
+    if (pool->num_workers == 0) {
+        thread_pool_destroy(pool);
+        return (NULL);
+    }
+
+    LOGDEBUG("started pool %s with %d worker(s)\n", pool->name, pool->num_workers);
+    return (pool);
+}
+
+//!
+//! Stops a pool once the tasks submitted to it are done, and frees it. The futures of all its
+//! tasks must have been waited on.
+//!
+//! @param[in] pool may be NULL
+//!
+//! @pre not to be called from a task of the pool
+//!
+void thread_pool_destroy(thread_pool * pool)
+{
+    int i = 0;
+
+    if (pool == NULL)
+        return;
+
+    __sync_lock_test_and_set(&(pool->stopping), 1);
+    for (i = 0; i < pool->num_workers; i++)
+        sem_verhogen(pool->wakeup, FALSE);
+    for (i = 0; i < pool->num_workers; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    LOGDEBUG("stopped pool %s: %lld task(s), %lld reclaimed, %lld stolen, at most %lld queued, %lld usec busy\n", pool->name, pool->stats.submitted,
+             pool->stats.reclaimed, pool->stats.stolen, pool->stats.queued_peak, pool->stats.busy_usec);
+
+    for (i = 0; i < pool->max_workers; i++) {
+        EUCA_FREE(pool->workers[i].queue.tasks);
+        pthread_mutex_destroy(&(pool->workers[i].queue.mutex));
+    }
+    EUCA_FREE(pool->injected.tasks);
+    pthread_mutex_destroy(&(pool->injected.mutex));
+    pthread_mutex_destroy(&(pool->done_mutex));
+    pthread_cond_destroy(&(pool->done_cond));
+    SEM_FREE(pool->wakeup);
+    EUCA_FREE(pool->workers);
+    EUCA_FREE(pool);
+}
+
+//!
+//! Submits a task to a pool
+//!
+//! @param[in] pool the pool to run the task, may be NULL
+//! @param[in] fn the function the task runs
+//! @param[in] arg the argument passed to fn
+//!
+//! @return the future of the task, which must be waited on with thread_pool_wait(), or NULL if
+//!         there is no pool or we are out of memory, in which case the caller runs fn itself
+//!
+thread_pool_future *thread_pool_submit(thread_pool * pool, thread_pool_fn fn, void *arg)
+{
+    thread_pool_queue *queue = NULL;
+    thread_pool_future *task = NULL;
+
+    if ((pool == NULL) || (fn == NULL))
+        return (NULL);
+
+    if ((task = EUCA_ZALLOC(1, sizeof(thread_pool_future))) == NULL)
+        return (NULL);
+
+    task->fn = fn;
+    task->arg = arg;
+    task->pool = pool;
+    task->state = TASK_QUEUED;
+    task->refs = 2;
+
+    queue = (((current_worker != NULL) && (current_worker->pool == pool)) ? &(current_worker->queue) : &(pool->injected));
+    if (queue_push(pool, queue, task) != EUCA_OK) {
+        EUCA_FREE(task);
+        return (NULL);
+    }
+
+    __sync_fetch_and_add(&(pool->stats.submitted), 1);
+    sem_verhogen(pool->wakeup, FALSE);
+    return (task);
+}
+
+//!
+//! Waits for a task to be done and frees its future. A task that no worker has started yet is
+//! run by the calling thread instead, and a worker of the pool runs the tasks of its own queue
+//! while it waits.
+//!
+//! @param[in] future the future returned by thread_pool_submit(), may be NULL
+//!
+//! @return the result of the task or NULL if future is NULL
+//!
+void *thread_pool_wait(thread_pool_future * future)
+{
+    void *result = NULL;
+    thread_pool *pool = NULL;
+    thread_pool_future *task = NULL;
+
+    if (future == NULL)
+        return (NULL);
+
+    pool = future->pool;
+    if (__sync_bool_compare_and_swap(&(future->state), TASK_QUEUED, TASK_RUNNING)) {
+        __sync_fetch_and_add(&(pool->stats.reclaimed), 1);
+        finish_task(future, future->fn(future->arg));
+    } else {
+        if ((current_worker != NULL) && (current_worker->pool == pool)) {
+            while (!task_is_done(future) && ((task = queue_pop(pool, &(current_worker->queue), TRUE)) != NULL))
+                run_task(task, FALSE);
+        }
+
+        pthread_mutex_lock(&(pool->done_mutex));
+        while (!task_is_done(future))
+            pthread_cond_wait(&(pool->done_cond), &(pool->done_mutex));
+        pthread_mutex_unlock(&(pool->done_mutex));
+    }
+
+    result = future->result;
+    release_task(future);
+    return (result);
+}
+
+//!
+//! Gets the usage statistics of a pool, which are updated while they are read
+//!
+//! @param[in]  pool
+//! @param[out] stats set to the statistics
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if any parameter is NULL
+//!
+int thread_pool_stats_get(thread_pool * pool, thread_pool_stats * stats)
+{
+    if ((pool == NULL) || (stats == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    memcpy(stats, &(pool->stats), sizeof(thread_pool_stats));
+    return (EUCA_OK);
+}
+
+//!
+//! Adds a task at the newest end of a queue, growing the queue if it is full
+//!
+//! @param[in] pool the pool of the queue
+//! @param[in] queue
+//! @param[in] task
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR if the queue could not grow
+//!
+static int queue_push(thread_pool * pool, thread_pool_queue * queue, thread_pool_future * task)
+{
+    int i = 0;
+    int size = 0;
+    long long queued = 0;
+    long long peak = 0;
+    thread_pool_future **tasks = NULL;
+
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->count == queue->size) {
+        size = ((queue->size > 0) ? (queue->size * 2) : THREAD_POOL_QUEUE_SIZE);
+        if ((tasks = EUCA_ZALLOC(size, sizeof(thread_pool_future *))) == NULL) {
+            pthread_mutex_unlock(&(queue->mutex));
+            return (EUCA_MEMORY_ERROR);
+        }
+        for (i = 0; i < queue->count; i++)
+            tasks[i] = queue->tasks[(queue->head + i) % queue->size];
+        EUCA_FREE(queue->tasks);
+        queue->tasks = tasks;
+        queue->size = size;
+        queue->head = 0;
+    }
+    queue->tasks[(queue->head + queue->count) % queue->size] = task;
+    queue->count++;
+    pthread_mutex_unlock(&(queue->mutex));
+
+    queued = __sync_add_and_fetch(&(pool->queued), 1);
+    while (((peak = __sync_fetch_and_add(&(pool->stats.queued_peak), 0)) < queued) && !__sync_bool_compare_and_swap(&(pool->stats.queued_peak), peak, queued)) ;
+    return (EUCA_OK);
+}
+
+//!
+//! Takes a task from a queue
+//!
+//! @param[in] pool the pool of the queue
+//! @param[in] queue
+//! @param[in] newest set to TRUE to take the newest task, as the owner of the queue does, or
+//!            FALSE for the oldest one
+//!
+//! @return the task or NULL if the queue is empty
+//!
+static thread_pool_future *queue_pop(thread_pool * pool, thread_pool_queue * queue, boolean newest)
+{
+    thread_pool_future *task = NULL;
+
+    pthread_mutex_lock(&(queue->mutex));
+    if (queue->count > 0) {
+        if (newest) {
+            task = queue->tasks[(queue->head + queue->count - 1) % queue->size];
+        } else {
+            task = queue->tasks[queue->head];
+            queue->head = ((queue->head + 1) % queue->size);
+        }
+        queue->count--;
+    }
+    pthread_mutex_unlock(&(queue->mutex));
+
+    if (task != NULL)
+        __sync_fetch_and_sub(&(pool->queued), 1);
+    return (task);
+}
+
+//!
+//! Finds the next task for a worker: the newest of its own queue, else the oldest submission
+//! from outside of the pool, else the oldest task of another worker
+//!
+//! @param[in] worker
+//!
+//! @return the task or NULL if all queues are empty
+//!
+static thread_pool_future *take_task(thread_pool_worker * worker)
+{
+    int i = 0;
+    thread_pool *pool = worker->pool;
+    thread_pool_queue *queue = NULL;
+    thread_pool_future *task = NULL;
+
+    if ((task = queue_pop(pool, &(worker->queue), TRUE)) != NULL)
+        return (task);
+
+    if ((task = queue_pop(pool, &(pool->injected), FALSE)) != NULL)
+        return (task);
+
+    for (i = 1; i < pool->max_workers; i++) {
+        queue = &(pool->workers[(worker->index + i) % pool->max_workers].queue);
+        if ((task = queue_pop(pool, queue, FALSE)) != NULL) {
+            __sync_fetch_and_add(&(pool->stats.stolen), 1);
+            return (task);
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Sets the result of a task and wakes up the threads waiting on tasks
+//!
+//! @param[in] task
+//! @param[in] result
+//!
+static void finish_task(thread_pool_future * task, void *result)
+{
+    thread_pool *pool = task->pool;
+
+    // counted first, so that whoever sees the task done also sees it in the statistics
+    __sync_fetch_and_add(&(pool->stats.completed), 1);
+    pthread_mutex_lock(&(pool->done_mutex));
+    task->result = result;
+    __sync_lock_test_and_set(&(task->state), TASK_DONE);
+    pthread_cond_broadcast(&(pool->done_cond));
+    pthread_mutex_unlock(&(pool->done_mutex));
+}
+
+//!
+//! Tells whether a task is done, reading its state atomically
+//!
+//! @param[in] task
+//!
+//! @return TRUE if the task is done
+//!
+static boolean task_is_done(thread_pool_future * task)
+{
+    return (__sync_bool_compare_and_swap(&(task->state), TASK_DONE, TASK_DONE));
+}
+
+//!
+//! Drops a reference to a task, freeing it with the last one
+//!
+//! @param[in] task
+//!
+static void release_task(thread_pool_future * task)
+{
+    if (__sync_sub_and_fetch(&(task->refs), 1) == 0)
+        EUCA_FREE(task);
+}
+
+//!
+//! Runs a task taken from a queue, unless the thread waiting on it took it first, and drops
+//! the reference of the queue
+//!
+//! @param[in] task
+//! @param[in] timed set to TRUE to add the time spent to the busy time of the pool, which
+//!            tasks run while waiting on another are already part of
+//!
+static void run_task(thread_pool_future * task, boolean timed)
+{
+    long long start_ticks = 0;
+    thread_pool *pool = task->pool;
+
+    if (__sync_bool_compare_and_swap(&(task->state), TASK_QUEUED, TASK_RUNNING)) {
+        if (timed)
+            start_ticks = fast_ticks();
+        finish_task(task, task->fn(task->arg));
+        if (timed)
+            __sync_fetch_and_add(&(pool->stats.busy_usec), fast_ticks_usec(fast_ticks() - start_ticks));
+    }
+    release_task(task);
+}
+
+//!
+//! Worker thread, which runs tasks until the pool is stopped and no task is left
+//!
+//! @param[in] arg pointer to the thread_pool_worker
+//!
+//! @return Always return NULL
+//!
+static void *worker_thread(void *arg)
+{
+    thread_pool_worker *worker = ((thread_pool_worker *) arg);
+    thread_pool_future *task = NULL;
+
+    current_worker = worker;
+    for (;;) {
+        if ((task = take_task(worker)) != NULL) {
+            run_task(task, TRUE);
+            continue;
+        }
+
+        if (__sync_fetch_and_add(&(worker->pool->stopping), 0))
+            break;
+        // every submission raises the semaphore, so a task queued after take_task() looked wakes us up
+        sem_prolaag(worker->pool->wakeup, FALSE);
+    }
+    current_worker = NULL;
+    return (NULL);
+}
+
+#ifdef _UNIT_TEST
+static pthread_mutex_t test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t test_cond = PTHREAD_COND_INITIALIZER;
+static boolean test_released = FALSE;
+static thread_pool *test_pool = NULL;
+
+//!
+//! Task of the unit test that squares its argument
+//!
+//! @param[in] arg the number to square
+//!
+//! @return the square
+//!
+static void *test_square(void *arg)
+{
+    long n = (long)arg;
+    return ((void *)(n * n));
+}
+
+//!
+//! Task of the unit test that counts the nodes of a binary tree, submitting a task for one
+//! subtree and counting the other itself
+//!
+//! @param[in] arg the depth of the tree
+//!
+//! @return the number of nodes
+//!
+static void *test_tree(void *arg)
+{
+    long depth = (long)arg;
+    long left = 0;
+    long right = 0;
+    thread_pool_future *future = NULL;
+
+    if (depth == 0)
+        return ((void *)1L);
+
+    if ((future = thread_pool_submit(test_pool, test_tree, (void *)(depth - 1))) == NULL)
+        left = (long)test_tree((void *)(depth - 1));
+    right = (long)test_tree((void *)(depth - 1));
+    if (future != NULL)
+        left = (long)thread_pool_wait(future);
+    return ((void *)(left + right + 1));
+}
+
+//!
+//! Task of the unit test that keeps its worker busy until the test releases it
+//!
+//! @param[in] arg not used
+//!
+//! @return NULL
+//!
+static void *test_block(void *arg)
+{
+    pthread_mutex_lock(&test_mutex);
+    while (!test_released)
+        pthread_cond_wait(&test_cond, &test_mutex);
+    pthread_mutex_unlock(&test_mutex);
+    return (NULL);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int main(int argc, char **argv)
+{
+    long i = 0;
+    long nodes = 0;
+    int errors = 0;
+    thread_pool_future *futures[1000] = { NULL };
+    thread_pool_future *blocker = NULL;
+    thread_pool_stats stats = { 0 };
+
+    logfile(NULL, EUCA_LOG_DEBUG, 4);
+    if ((thread_pool_create("bad", 0) != NULL) || (thread_pool_submit(NULL, test_square, NULL) != NULL) || (thread_pool_wait(NULL) != NULL)) {
+        LOGERROR("bad parameters were accepted\n");
+        errors++;
+    }
+    // many independent tasks
+    if ((test_pool = thread_pool_create("test", 4)) == NULL) {
+        LOGERROR("failed to create a pool\n");
+        return (EUCA_ERROR);
+    }
+    for (i = 0; i < 1000; i++)
+        futures[i] = thread_pool_submit(test_pool, test_square, (void *)i);
+    for (i = 0; i < 1000; i++) {
+        if ((futures[i] == NULL) || ((long)thread_pool_wait(futures[i]) != (i * i))) {
+            LOGERROR("task %ld got a wrong result\n", i);
+            errors++;
+        }
+    }
+    // tasks that wait on the tasks they submit, many more than there are workers
+    if ((nodes = (long)test_tree((void *)12L)) != 8191) {
+        LOGERROR("tree of 8191 nodes counted as %ld\n", nodes);
+        errors++;
+    }
+    thread_pool_destroy(test_pool);
+
+    // a waiter runs a task itself when the only worker is busy
+    if ((test_pool = thread_pool_create("test", 1)) == NULL) {
+        LOGERROR("failed to create a pool\n");
+        return (EUCA_ERROR);
+    }
+    blocker = thread_pool_submit(test_pool, test_block, NULL);
+    while (__sync_fetch_and_add(&(test_pool->queued), 0) > 0)
+        usleep(1000);
+    futures[0] = thread_pool_submit(test_pool, test_square, (void *)7L);
+    if ((long)thread_pool_wait(futures[0]) != 49) {
+        LOGERROR("reclaimed task got a wrong result\n");
+        errors++;
+    }
+    pthread_mutex_lock(&test_mutex);
+    test_released = TRUE;
+    pthread_cond_broadcast(&test_cond);
+    pthread_mutex_unlock(&test_mutex);
+    thread_pool_wait(blocker);
+
+    thread_pool_stats_get(test_pool, &stats);
+    if ((stats.workers != 1) || (stats.submitted != 2) || (stats.completed != 2) || (stats.reclaimed != 1)) {
+        LOGERROR("wrong statistics: %d worker(s), %lld submitted, %lld completed, %lld reclaimed\n", stats.workers, stats.submitted, stats.completed, stats.reclaimed);
+        errors++;
+    }
+    thread_pool_destroy(test_pool);
+
+    printf("thread pool tests %s\n", ((errors == 0) ? "passed" : "FAILED"));
+    return ((errors == 0) ? EUCA_OK : EUCA_ERROR);
+}
+#endif /* _UNIT_TEST */
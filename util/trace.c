@@ -0,0 +1,700 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/trace.c
+//! Request-scoped tracing spans, see trace.h
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "eucalyptus.h"
+#include "misc.h"
+#include "euca_string.h"
+#include "hash.h"
+#include "log.h"
+#include "trace.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define CORRELATION_ID_SEPARATOR                 "::"
+#define EXPORT_INITIAL_SIZE                      (64 * 1024)
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A span not finished yet
+typedef struct trace_open_span_t {
+    char id[TRACE_SPAN_ID_SIZE];
+    char parent_id[TRACE_SPAN_ID_SIZE];
+    char name[TRACE_NAME_SIZE];
+    trace_kind kind;
+    int shared;
+    long long start_us;
+} trace_open_span;
+
+//! Spans open on a thread, all of the same trace
+typedef struct trace_context_t {
+    char trace_id[TRACE_ID_SIZE];
+    char hop_id[TRACE_SPAN_ID_SIZE];   //!< span ID of the call answered, parent of the outermost spans
+    int depth;
+    trace_open_span open[TRACE_MAX_DEPTH];
+    char outgoing_corrid[TRACE_CORRELATION_ID_SIZE];    //!< of the call of the innermost client span
+} trace_context;
+
+//! Growable string for the export
+typedef struct trace_text_t {
+    char *buf;
+    size_t len;
+    size_t size;
+} trace_text;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#ifdef _UNIT_TEST
+const char *euca_this_component_name = "test";
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static trace_ring *ring_in_use = NULL;
+static __thread trace_context context = { {0} };
+static __thread unsigned long long span_counter = 0;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+static const char *get_hop(const char *correlation_id);
+static void make_trace_id(const char *correlation_id, char *id);
+static void make_span_id(const char *hop, char *id);
+static void make_random_span_id(char *id);
+static int set_context(const char *correlation_id);
+static int push_span(const char *name, trace_kind kind, const char *id, int shared);
+static void record_span(const trace_open_span * open, long long end_us, int failed);
+static int text_append(trace_text * text, const char *format, ...) _attribute_format_(2, 3);
+static void copy_name(char *dst, const char *src, size_t size);
+
+#ifdef _UNIT_TEST
+static int test_ids(void);
+static int test_spans(void);
+static int test_export(void);
+#endif /* _UNIT_TEST */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//!
+//! Sets the ring where the spans of this process are recorded. Until then, no span is recorded.
+//!
+//! @param[in] ring zeroed ring, or one already in use by other processes
+//!
+void trace_init(trace_ring * ring)
+{
+    ring_in_use = ring;
+}
+
+//!
+//! @return the ring of this process, or NULL if none was set
+//!
+trace_ring *trace_get_ring(void)
+{
+    return (ring_in_use);
+}
+
+//!
+//! Begins the answer to a call from another component. Any span left open on the thread by an
+//! earlier request is dropped.
+//!
+//! @param[in] name of the operation
+//! @param[in] correlation_id received with the call
+//!
+//! @return a handle for trace_end() or -1
+//!
+int trace_begin_server(const char *name, const char *correlation_id)
+{
+    context.depth = 0;
+    if (set_context(correlation_id) != EUCA_OK)
+        return (-1);
+    return (push_span(name, TRACE_KIND_SERVER, context.hop_id, TRUE));
+}
+
+//!
+//! Begins a call to another component, to be made with the correlation ID that
+//! trace_outgoing_corrid() returns next on this thread (as the stubs do).
+//!
+//! @param[in] name of the operation called
+//! @param[in] correlation_id of the request, used if no span is open on the thread
+//!
+//! @return a handle for trace_end() or -1
+//!
+int trace_begin_client(const char *name, const char *correlation_id)
+{
+    char *outgoing = NULL;
+    char id[TRACE_SPAN_ID_SIZE] = "";
+    int handle = -1;
+
+    if ((context.depth == 0) && (set_context(correlation_id) != EUCA_OK))
+        return (-1);
+
+    if ((outgoing = create_corrid(correlation_id)) == NULL)
+        return (-1);
+
+    make_span_id(get_hop(outgoing), id);
+    if ((handle = push_span(name, TRACE_KIND_CLIENT, id, FALSE)) >= 0) {
+        euca_strncpy(context.outgoing_corrid, outgoing, sizeof(context.outgoing_corrid));
+    }
+    EUCA_FREE(outgoing);
+    return (handle);
+}
+
+//!
+//! Begins a phase of the work on a request, inside the innermost span open on the thread or,
+//! on a thread working for a request (see set_corrid_pthread()), inside the span of the call
+//!
+//! @param[in] name of the phase
+//!
+//! @return a handle for trace_end() or -1
+//!
+int trace_begin(const char *name)
+{
+    threadCorrelationId *corr_id = NULL;
+    char id[TRACE_SPAN_ID_SIZE] = "";
+
+    if (context.depth == 0) {
+        if (((corr_id = get_corrid()) == NULL) || (set_context(corr_id->correlation_id) != EUCA_OK))
+            return (-1);
+    }
+    make_random_span_id(id);
+    return (push_span(name, TRACE_KIND_INTERNAL, id, FALSE));
+}
+
+//!
+//! Ends a span and the spans still open inside it, and records them
+//!
+//! @param[in] handle returned when the span began, nothing is done if -1
+//! @param[in] failed TRUE if the span ended with an error
+//!
+void trace_end(int handle, int failed)
+{
+    long long end_us = 0;
+
+    if ((handle < 0) || (handle >= context.depth))
+        return;
+
+    end_us = time_usec();
+    while (context.depth > handle) {
+        context.depth--;
+        record_span(&(context.open[context.depth]), end_us, ((context.depth == handle) ? failed : FALSE));
+    }
+    if (context.depth == 0) {
+        context.outgoing_corrid[0] = '\0';
+    }
+}
+
+//!
+//! Gets the correlation ID for an outgoing call: that of the innermost client span of the thread
+//! if it is open for the same request, or a new one otherwise
+//!
+//! @param[in] correlation_id of the request
+//!
+//! @return a correlation ID the caller frees, or NULL if correlation_id is not a proper one
+//!
+//! @see create_corrid()
+//!
+char *trace_outgoing_corrid(const char *correlation_id)
+{
+    char *outgoing = NULL;
+    const char *hop = get_hop(correlation_id);
+
+    if ((hop != NULL) && (context.outgoing_corrid[0] != '\0') && !strncmp(context.outgoing_corrid, correlation_id, (hop - correlation_id))) {
+        outgoing = strdup(context.outgoing_corrid);
+        context.outgoing_corrid[0] = '\0';
+        return (outgoing);
+    }
+    return (create_corrid(correlation_id));
+}
+
+//!
+//! Exports the spans of a ring as a JSON array of Zipkin v2 spans, oldest first. The spans stay
+//! in the ring until overwritten, so consecutive exports may have spans in common.
+//!
+//! @param[in]  ring to export
+//! @param[out] out the spans, which the caller frees
+//! @param[out] out_len length of out
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or EUCA_MEMORY_ERROR
+//!
+int trace_export_zipkin(trace_ring * ring, char **out, size_t * out_len)
+{
+    static const char *kinds[] = { NULL, "CLIENT", "SERVER" };
+    long long i = 0;
+    long long seq = 0;
+    long long next = 0;
+    int count = 0;
+    trace_span span = { 0 };
+    trace_span *slot = NULL;
+    trace_text text = { NULL, 0, 0 };
+
+    if ((ring == NULL) || (out == NULL) || (out_len == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    *out = NULL;
+    *out_len = 0;
+    if (text_append(&text, "[") != EUCA_OK)
+        return (EUCA_MEMORY_ERROR);
+
+    next = ring->next;
+    for (i = ((next > TRACE_RING_SIZE) ? (next - TRACE_RING_SIZE) : 0); i < next; i++) {
+        slot = &(ring->spans[i % TRACE_RING_SIZE]);
+        if (((seq = slot->seq) == 0) || (seq & 1))
+            continue;
+        __sync_synchronize();
+        memcpy(&span, slot, sizeof(span));
+        __sync_synchronize();
+        if (slot->seq != seq)
+            continue;
+
+        if ((text_append(&text, "%s{\"traceId\":\"%s\",\"id\":\"%s\"", ((count > 0) ? "," : ""), span.trace_id, span.id) != EUCA_OK)
+            || ((span.parent_id[0] != '\0') && (text_append(&text, ",\"parentId\":\"%s\"", span.parent_id) != EUCA_OK))
+            || ((span.kind != TRACE_KIND_INTERNAL) && (text_append(&text, ",\"kind\":\"%s\"", kinds[span.kind]) != EUCA_OK))
+            || (span.shared && (text_append(&text, ",\"shared\":true") != EUCA_OK))
+            || (text_append(&text, ",\"name\":\"%s\",\"timestamp\":%lld,\"duration\":%lld,\"localEndpoint\":{\"serviceName\":\"%s\"}",
+                            span.name, span.start_us, ((span.duration_us > 0) ? span.duration_us : 1), span.service) != EUCA_OK)
+            || (span.failed && (text_append(&text, ",\"tags\":{\"error\":\"true\"}") != EUCA_OK))
+            || (text_append(&text, "}") != EUCA_OK)) {
+            EUCA_FREE(text.buf);
+            return (EUCA_MEMORY_ERROR);
+        }
+        count++;
+    }
+
+    if (text_append(&text, "]") != EUCA_OK) {
+        EUCA_FREE(text.buf);
+        return (EUCA_MEMORY_ERROR);
+    }
+    *out = text.buf;
+    *out_len = text.len;
+    return (EUCA_OK);
+}
+
+//! @return the hop part of a correlation ID, or NULL if it has none
+static const char *get_hop(const char *correlation_id)
+{
+    const char *hop = NULL;
+
+    if ((correlation_id == NULL) || ((hop = strstr(correlation_id, CORRELATION_ID_SEPARATOR)) == NULL))
+        return (NULL);
+    hop += strlen(CORRELATION_ID_SEPARATOR);
+    return ((*hop != '\0') ? hop : NULL);
+}
+
+//! The trace ID is the request part of the correlation ID without its dashes when it is a UUID,
+//! or a hash of it otherwise
+static void make_trace_id(const char *correlation_id, char *id)
+{
+    int i = 0;
+    int digits = 0;
+    const char *hop = get_hop(correlation_id);
+    size_t len = (hop - correlation_id) - strlen(CORRELATION_ID_SEPARATOR);
+
+    for (i = 0; (i < len) && (digits < (TRACE_ID_SIZE - 1)); i++) {
+        if (isxdigit(correlation_id[i])) {
+            id[digits++] = tolower(correlation_id[i]);
+        } else if (correlation_id[i] != '-') {
+            break;
+        }
+    }
+    if ((i == len) && (digits == (TRACE_ID_SIZE - 1))) {
+        id[digits] = '\0';
+    } else {
+        snprintf(id, TRACE_ID_SIZE, "%016llx%016llx", (unsigned long long)euca_hash64(correlation_id, len, 0),
+                 (unsigned long long)euca_hash64(correlation_id, len, HASH64_P1));
+    }
+}
+
+//! The span ID of a call is derived from its hop ID, the same way by the caller and the callee
+static void make_span_id(const char *hop, char *id)
+{
+    u64 value = euca_hash64_str(hop);
+    snprintf(id, TRACE_SPAN_ID_SIZE, "%016llx", (unsigned long long)((value != 0) ? value : 1));
+}
+
+//! Span IDs of the other spans only need to be unique
+static void make_random_span_id(char *id)
+{
+    u64 value = 0;
+    struct {
+        pid_t pid;
+        pthread_t tid;
+        long long now;
+        unsigned long long counter;
+    } seed = { getpid(), pthread_self(), time_usec(), span_counter++ };
+
+    value = euca_hash64(&seed, sizeof(seed), 0);
+    snprintf(id, TRACE_SPAN_ID_SIZE, "%016llx", (unsigned long long)((value != 0) ? value : 1));
+}
+
+//! Starts the context of the thread for the request of a correlation ID
+static int set_context(const char *correlation_id)
+{
+    const char *hop = get_hop(correlation_id);
+
+    if ((ring_in_use == NULL) || (hop == NULL))
+        return (EUCA_ERROR);
+
+    make_trace_id(correlation_id, context.trace_id);
+    make_span_id(hop, context.hop_id);
+    context.depth = 0;
+    context.outgoing_corrid[0] = '\0';
+    return (EUCA_OK);
+}
+
+//! Opens a span inside the innermost one of the thread
+static int push_span(const char *name, trace_kind kind, const char *id, int shared)
+{
+    trace_open_span *open = NULL;
+
+    if (context.depth >= TRACE_MAX_DEPTH) {
+        LOGDEBUG("too many spans open, not tracing %s\n", SP(name));
+        return (-1);
+    }
+
+    open = &(context.open[context.depth]);
+    copy_name(open->name, name, sizeof(open->name));
+    euca_strncpy(open->id, id, sizeof(open->id));
+    if (kind == TRACE_KIND_SERVER) {
+        open->parent_id[0] = '\0';     // the caller knows it, the span is shared with its own
+    } else {
+        euca_strncpy(open->parent_id, ((context.depth > 0) ? context.open[context.depth - 1].id : context.hop_id), sizeof(open->parent_id));
+    }
+    open->kind = kind;
+    open->shared = shared;
+    open->start_us = time_usec();
+    return (context.depth++);
+}
+
+//! Writes a finished span in the ring. Dropped if its slot is being written by another thread,
+//! which only happens if the ring was filled in the meantime.
+static void record_span(const trace_open_span * open, long long end_us, int failed)
+{
+    long long seq = 0;
+    trace_span *slot = NULL;
+
+    if (ring_in_use == NULL)
+        return;
+
+    slot = &(ring_in_use->spans[__sync_fetch_and_add(&(ring_in_use->next), 1) % TRACE_RING_SIZE]);
+    seq = slot->seq;
+    if ((seq & 1) || !__sync_bool_compare_and_swap(&(slot->seq), seq, seq + 1))
+        return;
+
+    euca_strncpy(slot->trace_id, context.trace_id, sizeof(slot->trace_id));
+    euca_strncpy(slot->id, open->id, sizeof(slot->id));
+    euca_strncpy(slot->parent_id, open->parent_id, sizeof(slot->parent_id));
+    euca_strncpy(slot->name, open->name, sizeof(slot->name));
+    copy_name(slot->service, ((euca_this_component_name != NULL) ? euca_this_component_name : "eucalyptus"), sizeof(slot->service));
+    slot->kind = open->kind;
+    slot->shared = open->shared;
+    slot->failed = failed;
+    slot->start_us = open->start_us;
+    slot->duration_us = end_us - open->start_us;
+
+    __sync_synchronize();
+    slot->seq = seq + 2;
+}
+
+//! Appends to a growable string
+static int text_append(trace_text * text, const char *format, ...)
+{
+    int len = 0;
+    char *larger = NULL;
+    va_list ap = { {0} };
+
+    for (;;) {
+        if (text->size > text->len) {
+            va_start(ap, format);
+            len = vsnprintf(text->buf + text->len, text->size - text->len, format, ap);
+            va_end(ap);
+            if (len < 0)
+                return (EUCA_ERROR);
+            if ((text->len + len) < text->size) {
+                text->len += len;
+                return (EUCA_OK);
+            }
+        }
+        if ((larger = EUCA_REALLOC(text->buf, ((text->size > 0) ? (text->size * 2) : EXPORT_INITIAL_SIZE), sizeof(char))) == NULL)
+            return (EUCA_MEMORY_ERROR);
+        text->buf = larger;
+        text->size = ((text->size > 0) ? (text->size * 2) : EXPORT_INITIAL_SIZE);
+    }
+}
+
+//! Copies a name, with the characters that would need escaping in JSON replaced
+static void copy_name(char *dst, const char *src, size_t size)
+{
+    size_t i = 0;
+
+    for (i = 0; (src != NULL) && (src[i] != '\0') && (i < (size - 1)); i++) {
+        dst[i] = ((isprint(src[i]) && (src[i] != '"') && (src[i] != '\\')) ? src[i] : '_');
+    }
+    dst[i] = '\0';
+}
+
+#ifdef _UNIT_TEST
+static const char *test_corrid = "6c1f2bd1-5b3a-4e0b-9a4f-0d8a1b2c3d4e::a1b2c3d4-0001-4c5d-8e9f-0a1b2c3d4e5f";
+
+//! Checks the IDs derived from correlation IDs
+static int test_ids(void)
+{
+    char id[TRACE_ID_SIZE] = "";
+    char span_id[TRACE_SPAN_ID_SIZE] = "";
+
+    make_trace_id(test_corrid, id);
+    if (strcmp(id, "6c1f2bd15b3a4e0b9a4f0d8a1b2c3d4e")) {
+        LOGERROR("unexpected trace ID %s\n", id);
+        return (EUCA_ERROR);
+    }
+    make_trace_id("not-a-uuid::a1b2c3d4-0001-4c5d-8e9f-0a1b2c3d4e5f", id);
+    if (strlen(id) != (TRACE_ID_SIZE - 1)) {
+        LOGERROR("unexpected trace ID %s\n", id);
+        return (EUCA_ERROR);
+    }
+    make_span_id(get_hop(test_corrid), span_id);
+    if ((strlen(span_id) != (TRACE_SPAN_ID_SIZE - 1)) || (get_hop("unset") != NULL) || (get_hop("abc::") != NULL)) {
+        LOGERROR("unexpected span ID %s or hops\n", span_id);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//! Checks the nesting of spans and the propagation of the span of a call
+static int test_spans(void)
+{
+    int server = -1;
+    int phase = -1;
+    int client = -1;
+    int ret = EUCA_OK;
+    char *outgoing = NULL;
+    char hop_id[TRACE_SPAN_ID_SIZE] = "";
+    char client_hop_id[TRACE_SPAN_ID_SIZE] = "";
+    trace_ring *ring = trace_get_ring();
+    trace_span *spans = ring->spans;
+    long long first = ring->next;
+
+    if (trace_begin("nothing") != -1 || trace_begin_server("nothing", "unset") != -1) {
+        LOGERROR("span recorded without a correlation ID\n");
+        return (EUCA_ERROR);
+    }
+
+    server = trace_begin_server("RunInstances", test_corrid);
+    phase = trace_begin("schedule");
+    trace_end(phase, FALSE);
+    client = trace_begin_client("ncRunInstance", test_corrid);
+    outgoing = trace_outgoing_corrid(test_corrid);
+    trace_begin("left open");
+    trace_end(server, TRUE);
+
+    if ((server != 0) || (phase != 1) || (client != 1) || (outgoing == NULL) || ((ring->next - first) != 4)) {
+        LOGERROR("unexpected handles %d %d %d or spans %lld\n", server, phase, client, (ring->next - first));
+        EUCA_FREE(outgoing);
+        return (EUCA_ERROR);
+    }
+
+    make_span_id(get_hop(test_corrid), hop_id);
+    make_span_id(get_hop(outgoing), client_hop_id);
+    // schedule, left open, ncRunInstance, RunInstances
+    if (strcmp(spans[first].name, "schedule") || strcmp(spans[first].parent_id, hop_id) || strcmp(spans[first + 2].name, "ncRunInstance")
+        || strcmp(spans[first + 2].id, client_hop_id) || (spans[first + 2].kind != TRACE_KIND_CLIENT) || strcmp(spans[first + 1].parent_id, client_hop_id)
+        || strcmp(spans[first + 3].id, hop_id) || spans[first + 3].parent_id[0] || !spans[first + 3].shared || !spans[first + 3].failed || spans[first + 2].failed
+        || strncmp(outgoing, test_corrid, 38) || !strcmp(outgoing, test_corrid)) {
+        LOGERROR("unexpected spans\n");
+        ret = EUCA_ERROR;
+    }
+    EUCA_FREE(outgoing);
+
+    // the next call without a client span gets a new hop
+    outgoing = trace_outgoing_corrid(test_corrid);
+    if ((outgoing == NULL) || !strcmp(outgoing, test_corrid)) {
+        LOGERROR("unexpected outgoing correlation ID %s\n", SP(outgoing));
+        ret = EUCA_ERROR;
+    }
+    EUCA_FREE(outgoing);
+    return (ret);
+}
+
+//! Checks the export of the spans, including after the ring wrapped
+static int test_export(void)
+{
+    int i = 0;
+    int handle = -1;
+    char *out = NULL;
+    size_t len = 0;
+
+    if ((trace_export_zipkin(trace_get_ring(), &out, &len) != EUCA_OK) || (strstr(out, "\"kind\":\"SERVER\",\"shared\":true,\"name\":\"RunInstances\"") == NULL)
+        || (strstr(out, "\"tags\":{\"error\":\"true\"}") == NULL) || (out[0] != '[') || (out[len - 1] != ']')) {
+        LOGERROR("unexpected export %s\n", SP(out));
+        EUCA_FREE(out);
+        return (EUCA_ERROR);
+    }
+    LOGINFO("exported %s\n", out);
+    EUCA_FREE(out);
+
+    for (i = 0; i < (TRACE_RING_SIZE + 10); i++) {
+        handle = trace_begin_server("again", test_corrid);
+        trace_end(handle, FALSE);
+    }
+    if ((trace_export_zipkin(trace_get_ring(), &out, &len) != EUCA_OK) || (strstr(out, "RunInstances") != NULL)) {
+        LOGERROR("unexpected export after the ring wrapped\n");
+        EUCA_FREE(out);
+        return (EUCA_ERROR);
+    }
+    LOGINFO("exported %zu bytes after the ring wrapped\n", len);
+    EUCA_FREE(out);
+    return (EUCA_OK);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+int main(int argc, char **argv)
+{
+    static trace_ring ring = { 0 };
+    int failures = 0;
+
+    logfile(NULL, EUCA_LOG_DEBUG, 4);
+    trace_init(&ring);
+
+    failures += (test_ids() != EUCA_OK);
+    failures += (test_spans() != EUCA_OK);
+    failures += (test_export() != EUCA_OK);
+
+    printf("trace tests %s\n", ((failures == 0) ? "passed" : "FAILED"));
+    return ((failures == 0) ? EUCA_OK : EUCA_ERROR);
+}
+#endif /* _UNIT_TEST */
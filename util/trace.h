@@ -0,0 +1,195 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+#ifndef _INCLUDE_TRACE_H_
+#define _INCLUDE_TRACE_H_
+
+//!
+//! @file util/trace.h
+//! Request-scoped tracing spans, keyed on the correlation ID of the requests. Spans are
+//! recorded in a ring, which may live in memory shared by several processes, and are
+//! exported in the Zipkin v2 JSON format.
+//!
+//! A correlation ID is made of the ID of the request and the ID of the hop, "<request>::<hop>",
+//! and each outgoing call gets a new hop ID (see create_corrid()). The trace ID is the request
+//! ID without its dashes and the span IDs of a call are derived from its hop ID, so the client
+//! span of a call and the server span of the component answering it share the same span ID,
+//! with nothing but the correlation ID passed along.
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#include <stddef.h>
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#define TRACE_RING_SIZE                          4096   //!< spans kept for export, the oldest ones overwritten
+#define TRACE_MAX_DEPTH                          16     //!< spans open at once on a thread
+#define TRACE_ID_SIZE                            33     //!< 32 hex digits
+#define TRACE_SPAN_ID_SIZE                       17     //!< 16 hex digits
+#define TRACE_NAME_SIZE                          48
+#define TRACE_SERVICE_SIZE                       16
+#define TRACE_CORRELATION_ID_SIZE                128
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Kinds of spans, as in Zipkin
+typedef enum trace_kind_t {
+    TRACE_KIND_INTERNAL,               //!< a phase of the work of a component
+    TRACE_KIND_CLIENT,                 //!< a call to another component
+    TRACE_KIND_SERVER,                 //!< the answer to a call from another component
+} trace_kind;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! A finished span
+typedef struct trace_span_t {
+    volatile long long seq;            //!< odd while the span is being written, 0 if never written
+    char trace_id[TRACE_ID_SIZE];
+    char id[TRACE_SPAN_ID_SIZE];
+    char parent_id[TRACE_SPAN_ID_SIZE];        //!< empty for a root span
+    char name[TRACE_NAME_SIZE];
+    char service[TRACE_SERVICE_SIZE];  //!< component that recorded the span
+    trace_kind kind;
+    int shared;                        //!< a server span with the ID of the client span of the call
+    int failed;
+    long long start_us;                //!< microseconds since the epoch
+    long long duration_us;
+} trace_span;
+
+//! Ring of the finished spans, written without locks by all the threads (and processes) sharing it
+typedef struct trace_ring_t {
+    volatile long long next;           //!< number of spans ever recorded
+    trace_span spans[TRACE_RING_SIZE];
+} trace_ring;
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXPORTED PROTOTYPES                            |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+void trace_init(trace_ring * ring);
+trace_ring *trace_get_ring(void);
+
+//! @{
+//! @name spans of the calling thread, nested. Each begin returns a handle to pass to trace_end(),
+//!       or -1 if the span is not recorded (no ring or no correlation ID), which trace_end() ignores
+int trace_begin_server(const char *name, const char *correlation_id);
+int trace_begin_client(const char *name, const char *correlation_id);
+int trace_begin(const char *name);
+void trace_end(int handle, int failed);
+//! @}
+
+char *trace_outgoing_corrid(const char *correlation_id);
+int trace_export_zipkin(trace_ring * ring, char **out, size_t * out_len);
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                           STATIC INLINE PROTOTYPES                         |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                          STATIC INLINE IMPLEMENTATION                      |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+#endif /* ! _INCLUDE_TRACE_H_ */
@@ -90,6 +90,7 @@
 
 #include "eucalyptus.h"
 #include "misc.h"                      // boolean
+#include "hash.h"
 #include "wc.h"
 
 /*----------------------------------------------------------------------------*\
@@ -163,7 +164,8 @@ static char_map **c_m = NULL;
 static wchar_t *find_valn(const wchar_map * vars[], const wchar_t * name, size_t name_len);
 static char *c_find_valn(const char_map * vars[], const char *name, size_t name_len);
 static wchar_t *wcappendn(wchar_t * dst, const wchar_t * src, size_t src_limit);
-static char *c_wcappendn(char *dst, const char *src, size_t src_limit);
+static const char *c_find_val_index(const char_map_index * index, const char_template_part * part, size_t * val_len);
+static char *c_render(const char_template * t, const char_map * vars[], const char_map_index * index);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -234,48 +236,27 @@ static char *c_find_valn(const char_map * vars[], const char *name, size_t name_
 }
 
 //!
-//! appends string 'src' to 'dst', up to 'src_len' characters (unless set
-//! to 0, in which case to the end of 'src'), enlarging the 'dst' as necessary
-//! returns the concatenated string or NULL if memory could not be allocated
-//! if 'src' is an empty string, 'dst' is returned.
+//! searches a hashed variable map for the variable of a template part
 //!
-//! @param[in] dst the destination string to append to
-//! @param[in] src the source string to add to 'dst'
-//! @param[in] src_limit the number of character to append from 'src'
+//! @param[in]  index the hashed map
+//! @param[in]  part the variable reference, with its name hashed
+//! @param[out] val_len set to the length of the value, if found
 //!
-//! @return the concatenated string or NULL if memory could not be allocated
-//!         if 'src' is an empty string, 'dst' is returned.
+//! @return the looked up value if found otherwise NULL is returned
 //!
-static wchar_t *wcappendn(wchar_t * dst, const wchar_t * src, size_t src_limit)
+static const char *c_find_val_index(const char_map_index * index, const char_template_part * part, size_t * val_len)
 {
-    size_t src_len = 0;
-    size_t dst_len = 0;
-
-    // Make sure we have a valid source
-    if (src == NULL)
-        return (dst);
-
-    // Should not be empty
-    if ((src_len = wcslen(src)) < 1)
-        return (dst);
-
-    // Estimate the proper length
-    if ((src_len > src_limit) && (src_limit > 0))
-        src_len = src_limit;
-
-    if (dst != NULL) {
-        dst_len = wcslen(dst);
-        if ((dst = (wchar_t *) EUCA_REALLOC(dst, (dst_len + src_len + 1), sizeof(wchar_t))) == NULL) {
-            return (NULL);
+    u32 i = 0;
+    const char_map_index_slot *slot = NULL;
+
+    for (i = part->hash & (index->size - 1); index->slots[i].name != NULL; i = (i + 1) & (index->size - 1)) {
+        slot = &index->slots[i];
+        if ((slot->hash == part->hash) && (slot->name_len == part->len) && !strncmp(slot->name, part->str, part->len)) {
+            *val_len = slot->val_len;
+            return (slot->val);
         }
-    } else {
-        if ((dst = (wchar_t *) EUCA_ALLOC((dst_len + src_len + 1), sizeof(wchar_t))) == NULL) {
-            return (NULL);
-        }
-        *dst = L'\0';
     }
-
-    return (wcsncat(dst, src, src_len));
+    return (NULL);
 }
 
 //!
@@ -291,7 +272,7 @@ static wchar_t *wcappendn(wchar_t * dst, const wchar_t * src, size_t src_limit)
 //! @return the concatenated string or NULL if memory could not be allocated
 //!         if 'src' is an empty string, 'dst' is returned.
 //!
-static char *c_wcappendn(char *dst, const char *src, size_t src_limit)
+static wchar_t *wcappendn(wchar_t * dst, const wchar_t * src, size_t src_limit)
 {
     size_t src_len = 0;
     size_t dst_len = 0;
@@ -301,7 +282,7 @@ static char *c_wcappendn(char *dst, const char *src, size_t src_limit)
         return (dst);
 
     // Should not be empty
-    if ((src_len = strlen(src)) < 1)
+    if ((src_len = wcslen(src)) < 1)
         return (dst);
 
     // Estimate the proper length
@@ -309,18 +290,18 @@ static char *c_wcappendn(char *dst, const char *src, size_t src_limit)
         src_len = src_limit;
 
     if (dst != NULL) {
-        dst_len = strlen(dst);
-        if ((dst = (char *)EUCA_REALLOC(dst, (dst_len + src_len + 1), sizeof(char))) == NULL) {
+        dst_len = wcslen(dst);
+        if ((dst = (wchar_t *) EUCA_REALLOC(dst, (dst_len + src_len + 1), sizeof(wchar_t))) == NULL) {
             return (NULL);
         }
     } else {
-        if ((dst = (char *)EUCA_ALLOC((dst_len + src_len + 1), sizeof(char))) == NULL) {
+        if ((dst = (wchar_t *) EUCA_ALLOC((dst_len + src_len + 1), sizeof(wchar_t))) == NULL) {
             return (NULL);
         }
-        *dst = '\0';
+        *dst = L'\0';
     }
 
-    return (strncat(dst, src, src_len));
+    return (wcsncat(dst, src, src_len));
 }
 
 //!
@@ -474,33 +455,24 @@ void varmap_free(wchar_map ** map)
 
 //!
 //! substitutes in 's' all occurence of variables '${var}'
-//! based on the 'vars' map (NULL-terminated array of wchar_map * pointers)
-//! returns a new string with all variables substituted or returns NULL
-//! (and logs an error with logprintfl()) if some variables were not
-//! found in the map or if the map is empty
+//! based on the 'vars' map (NULL-terminated array of char_map * pointers).
+//! Variables that are not in the map are left as they are, with a warning.
 //!
 //! @param[in] s the string containing variables
 //! @param[in] vars the list of variables
 //!
-//! @return a string containing the substitution
+//! @return a string containing the substitution, or NULL if it is empty or on error
 //!
 //! @pre The s field must not be NULL
 //!
 //! @note caller is responsible to free the returned string
 //!
+//! @see c_varsub_compile() and c_varsub_render() for strings substituted repeatedly
+//!
 char *c_varsub(const char *s, const char_map * vars[])
 {
-    boolean malformed = FALSE;
     char *result = NULL;
-    const char *remainder = s;
-    char *var_start = NULL;
-    char *var_end = NULL;
-    char *val = NULL;
-    char *missed_var = NULL;
-    char *vartok = NULL;
-    size_t var_len = 0;
-    size_t pref_len = strlen(C_VAR_PREFIX);
-    size_t suff_len = strlen(C_VAR_SUFFIX);
+    char_template *t = NULL;
 
     if (s == NULL) {
         return (NULL);
@@ -510,79 +482,15 @@ char *c_varsub(const char *s, const char_map * vars[])
         return ((char *)strdup(s));
     }
 
-    while ((var_start = strstr(remainder, C_VAR_PREFIX)) != NULL) {
-        // we have a beginning of a variable
-        if (strlen(var_start) <= (pref_len + suff_len)) {
-            // nothing past the prefix
-            malformed = TRUE;
-            break;
-        }
-
-        if ((var_end = strstr(var_start + pref_len, C_VAR_SUFFIX)) == NULL) {
-            // not suffix after prefix
-            malformed = TRUE;
-            break;
-        }
-        // length of the variable
-        var_len = var_end - var_start - pref_len;
-        if (var_len < 1) {
-            // empty var name
-            remainder = var_end + suff_len; // move the pointer past the empty variable (skip it)
-            malformed = TRUE;
-            continue;
-        }
-
-        if ((val = c_find_valn(vars, var_start + pref_len, var_len)) == NULL) {
-            if ((missed_var = strndup(var_start + pref_len, var_len)) == NULL) {
-                LOGWARN("failed to substitute variable\n");
-                continue;
-            } else {
-                LOGWARN("substituted variable: %s%s%s\n", C_VAR_PREFIX, missed_var, C_VAR_SUFFIX);
-            }
-
-            if ((vartok = (char *)EUCA_ALLOC(1, (strlen(C_VAR_PREFIX) + strlen(C_VAR_SUFFIX) + strlen(missed_var) + 1))) == NULL) {
-                EUCA_FREE(result);
-                EUCA_FREE(missed_var);
-                return (NULL);
-            }
-
-            sprintf(vartok, "%s%s%s", C_VAR_PREFIX, missed_var, C_VAR_SUFFIX);
-            if (var_start > remainder) {    // there is text prior to the variable
-                if ((result = c_wcappendn(result, remainder, var_start - remainder)) == NULL) {
-                    //! @todo more specific error
-                    LOGERROR("failed to append during variable substitution");
-                    EUCA_FREE(vartok);
-                    EUCA_FREE(missed_var);
-                    break;
-                }
-            }
-
-            result = c_wcappendn(result, vartok, 0);
-            remainder = var_end + suff_len; // move the pointer past the empty variable (skip it)
-            EUCA_FREE(missed_var);
-            EUCA_FREE(vartok);
-            continue;
-        }
-
-        if (var_start > remainder) {
-            // there is text prior to the variable
-            if ((result = c_wcappendn(result, remainder, var_start - remainder)) == NULL) {
-                //! @todo more specific error
-                LOGERROR("failed to append during variable substitution");
-                break;
-            }
-        }
-
-        result = c_wcappendn(result, val, 0);
-        remainder = var_end + suff_len;
+    if (strstr(s, C_VAR_PREFIX) == NULL) {
+        // nothing to substitute (and, as always, an empty result is no result)
+        return ((s[0] != '\0') ? strdup(s) : NULL);
     }
-    result = c_wcappendn(result, remainder, 0);
 
-    if (malformed) {
-        //! @todo print the string
-        LOGWARN("malformed string used for substitution\n");
+    if ((t = c_varsub_compile(s)) != NULL) {
+        result = c_varsub_render(t, vars);
+        c_varsub_free(t);
     }
-
     return (result);
 }
 
@@ -645,6 +553,296 @@ void c_varmap_free(char_map ** map)
     }
 }
 
+//!
+//! Splits a string at its variables '${var}' once, so that it can be substituted many
+//! times by c_varsub_render() or c_varsub_render_index() without being parsed again. The
+//! string is read the way c_varsub() always has: an empty variable '${}' is dropped along
+//! with the text since the previous variable, and a '${' with no '}' after it, or with at
+//! most one character after it, ends the parsing and is kept with the rest of the text.
+//!
+//! @param[in] s the string containing variables
+//!
+//! @return the compiled template, to be freed with c_varsub_free(), or NULL on error
+//!
+char_template *c_varsub_compile(const char *s)
+{
+    boolean malformed = FALSE;
+    int nparts = 1;
+    const char *remainder = NULL;
+    const char *var_start = NULL;
+    const char *var_end = NULL;
+    size_t pref_len = strlen(C_VAR_PREFIX);
+    size_t suff_len = strlen(C_VAR_SUFFIX);
+    char_template *t = NULL;
+    char_template_part *part = NULL;
+
+    if (s == NULL) {
+        return (NULL);
+    }
+    // every variable adds at most itself and the text before it
+    for (var_start = strstr(s, C_VAR_PREFIX); var_start; var_start = strstr(var_start + pref_len, C_VAR_PREFIX))
+        nparts += 2;
+
+    if ((t = EUCA_ZALLOC(1, sizeof(char_template))) == NULL) {
+        return (NULL);
+    }
+
+    if (((t->text = strdup(s)) == NULL) || ((t->parts = EUCA_ZALLOC(nparts, sizeof(char_template_part))) == NULL)) {
+        c_varsub_free(t);
+        return (NULL);
+    }
+
+    remainder = t->text;
+    while ((var_start = strstr(remainder, C_VAR_PREFIX)) != NULL) {
+        // we have a beginning of a variable: there must be a name and a suffix past the prefix
+        if ((strnlen(var_start, (pref_len + suff_len + 1)) <= (pref_len + suff_len)) || ((var_end = strstr(var_start + pref_len, C_VAR_SUFFIX)) == NULL)) {
+            malformed = TRUE;
+            break;
+        }
+
+        if (var_end == (var_start + pref_len)) {
+            // empty var name
+            remainder = var_end + suff_len; // move the pointer past the empty variable (skip it)
+            malformed = TRUE;
+            continue;
+        }
+
+        if (var_start > remainder) {
+            // there is text prior to the variable
+            part = &t->parts[t->nparts++];
+            part->str = remainder;
+            part->len = var_start - remainder;
+            t->literal_len += part->len;
+        }
+
+        part = &t->parts[t->nparts++];
+        part->str = var_start + pref_len;
+        part->len = var_end - var_start - pref_len;
+        part->hash = euca_hash64(part->str, part->len, 0);
+        part->var = TRUE;
+        remainder = var_end + suff_len;
+    }
+
+    if (*remainder != '\0') {
+        part = &t->parts[t->nparts++];
+        part->str = remainder;
+        part->len = strlen(remainder);
+        t->literal_len += part->len;
+    }
+
+    if (malformed) {
+        LOGWARN("malformed string used for substitution: %s\n", s);
+    }
+    return (t);
+}
+
+//!
+//! Frees a template compiled by c_varsub_compile()
+//!
+//! @param[in] t the template to free, may be NULL
+//!
+void c_varsub_free(char_template * t)
+{
+    if (t != NULL) {
+        EUCA_FREE(t->parts);
+        EUCA_FREE(t->text);
+        EUCA_FREE(t);
+    }
+}
+
+//!
+//! Substitutes the variables of a compiled template, from a map or an index of it, into
+//! a string allocated at its final length.
+//!
+//! @param[in] t the template
+//! @param[in] vars the list of variables, used when index is NULL
+//! @param[in] index the hashed list of variables, or NULL
+//!
+//! @return the substituted string, or NULL if it is empty or on error
+//!
+static char *c_render(const char_template * t, const char_map * vars[], const char_map_index * index)
+{
+    int i = 0;
+    int pass = 0;
+    size_t len = 0;
+    size_t pref_len = strlen(C_VAR_PREFIX);
+    size_t suff_len = strlen(C_VAR_SUFFIX);
+    char *result = NULL;
+    char *p = NULL;
+    const char *val = NULL;
+    size_t val_len = 0;
+    const char_template_part *part = NULL;
+
+    // the first pass adds up the length, the second one copies
+    for (pass = 0, len = t->literal_len; pass < 2; pass++) {
+        for (i = 0; i < t->nparts; i++) {
+            part = &t->parts[i];
+            if (!part->var) {
+                if (pass) {
+                    memcpy(p, part->str, part->len);
+                    p += part->len;
+                }
+                continue;
+            }
+
+            if (index != NULL) {
+                val = c_find_val_index(index, part, &val_len);
+            } else if ((val = c_find_valn(vars, part->str, part->len)) != NULL) {
+                val_len = strlen(val);
+            }
+
+            if (val == NULL) {
+                if (pass == 0) {
+                    LOGWARN("substituted variable: %s%.*s%s\n", C_VAR_PREFIX, ((int)part->len), part->str, C_VAR_SUFFIX);
+                    len += pref_len + part->len + suff_len;
+                } else {
+                    memcpy(p, C_VAR_PREFIX, pref_len);
+                    memcpy(p + pref_len, part->str, part->len);
+                    memcpy(p + pref_len + part->len, C_VAR_SUFFIX, suff_len);
+                    p += pref_len + part->len + suff_len;
+                }
+            } else if (pass == 0) {
+                len += val_len;
+            } else {
+                memcpy(p, val, val_len);
+                p += val_len;
+            }
+        }
+
+        if (pass == 0) {
+            // as c_varsub() always did, an empty result is no result
+            if ((len == 0) || ((result = EUCA_ALLOC((len + 1), sizeof(char))) == NULL))
+                return (NULL);
+            p = result;
+        }
+    }
+    *p = '\0';
+    return (result);
+}
+
+//!
+//! Substitutes the variables of a compiled template with their values in a map, like
+//! c_varsub() does for the string the template was compiled from, but without parsing it
+//! again and with a single allocation for the result.
+//!
+//! @param[in] t the template
+//! @param[in] vars the list of variables
+//!
+//! @return the substituted string, or NULL if it is empty or on error
+//!
+//! @note caller is responsible to free the returned string
+//!
+char *c_varsub_render(const char_template * t, const char_map * vars[])
+{
+    if (t == NULL) {
+        return (NULL);
+    }
+
+    if (vars == NULL) {
+        return ((char *)strdup(t->text));
+    }
+    return (c_render(t, vars, NULL));
+}
+
+//!
+//! Hashes a variable map, for rendering templates against the same values many times.
+//! A variable name matches the first key of the map that starts with it, as in c_varsub(),
+//! so every prefix of every key is indexed. The index points into the map, which must
+//! outlive it.
+//!
+//! @param[in] vars the list of variables
+//!
+//! @return the index, to be freed with c_varmap_index_free(), or NULL on error
+//!
+char_map_index *c_varmap_index(const char_map * vars[])
+{
+    int i = 0;
+    u32 j = 0;
+    u32 count = 0;
+    u64 hash = 0;
+    size_t len = 0;
+    size_t val_len = 0;
+    char_map_index *index = NULL;
+    char_map_index_slot *slot = NULL;
+
+    if (vars == NULL) {
+        return (NULL);
+    }
+
+    for (i = 0; vars[i] != NULL; i++) {
+        count += strlen(vars[i]->key);
+    }
+
+    if ((index = EUCA_ZALLOC(1, sizeof(char_map_index))) == NULL) {
+        return (NULL);
+    }
+
+    for (index->size = 16; index->size < (count * 2); index->size *= 2) ;
+    if ((index->slots = EUCA_ZALLOC(index->size, sizeof(char_map_index_slot))) == NULL) {
+        EUCA_FREE(index);
+        return (NULL);
+    }
+
+    for (i = 0; vars[i] != NULL; i++) {
+        val_len = strlen(vars[i]->val);
+        for (len = 1; vars[i]->key[len - 1] != '\0'; len++) {
+            hash = euca_hash64(vars[i]->key, len, 0);
+            for (j = hash & (index->size - 1); index->slots[j].name != NULL; j = (j + 1) & (index->size - 1)) {
+                if ((index->slots[j].hash == hash) && (index->slots[j].name_len == len) && !strncmp(index->slots[j].name, vars[i]->key, len))
+                    break;
+            }
+
+            // an earlier key already answers for this name
+            if (index->slots[j].name != NULL)
+                continue;
+
+            slot = &index->slots[j];
+            slot->name = vars[i]->key;
+            slot->name_len = len;
+            slot->hash = hash;
+            slot->val = vars[i]->val;
+            slot->val_len = val_len;
+        }
+    }
+    return (index);
+}
+
+//!
+//! Frees an index made by c_varmap_index()
+//!
+//! @param[in] index the index to free, may be NULL
+//!
+void c_varmap_index_free(char_map_index * index)
+{
+    if (index != NULL) {
+        EUCA_FREE(index->slots);
+        EUCA_FREE(index);
+    }
+}
+
+//!
+//! Substitutes the variables of a compiled template with their values in a hashed map;
+//! the result is the same as c_varsub_render() with the map the index was built from.
+//!
+//! @param[in] t the template
+//! @param[in] index the hashed list of variables
+//!
+//! @return the substituted string, or NULL if it is empty or on error
+//!
+//! @note caller is responsible to free the returned string
+//!
+char *c_varsub_render_index(const char_template * t, const char_map_index * index)
+{
+    if (t == NULL) {
+        return (NULL);
+    }
+
+    if (index == NULL) {
+        return ((char *)strdup(t->text));
+    }
+    return (c_render(t, NULL, index));
+}
+
 #ifdef _UNIT_TEST
 //!
 //! Main entry point of the application
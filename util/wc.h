@@ -120,6 +120,37 @@ typedef struct char_map_struct {
     char *val;                         //!< The replacement value
 } char_map;
 
+//! A piece of a compiled template: literal text or a variable reference
+typedef struct char_template_part_struct {
+    const char *str;                   //!< Start of the text, or of the variable name, within the template's text
+    size_t len;                        //!< Length of the text or of the name
+    u64 hash;                          //!< Hash of the variable name, for c_varsub_render_index()
+    boolean var;                       //!< TRUE if this part is a variable reference
+} char_template_part;
+
+//! A string split once at its variables by c_varsub_compile(), to be substituted many times
+typedef struct char_template_struct {
+    char *text;                        //!< Copy of the string, which the parts point into
+    int nparts;                        //!< Number of parts
+    size_t literal_len;                //!< Total length of the literal parts
+    char_template_part *parts;         //!< The parts, in order
+} char_template;
+
+//! A slot of a char_map_index
+typedef struct char_map_index_slot_struct {
+    const char *name;                  //!< Variable name the slot answers for (a prefix of a key), or NULL if free
+    size_t name_len;                   //!< Length of the name
+    u64 hash;                          //!< Hash of the name
+    const char *val;                   //!< The replacement value
+    size_t val_len;                    //!< Length of the value
+} char_map_index_slot;
+
+//! A char variable map hashed by c_varmap_index(), which points into the map it was built from
+typedef struct char_map_index_struct {
+    u32 size;                          //!< Number of slots, a power of 2
+    char_map_index_slot *slots;        //!< The slots
+} char_map_index;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -146,6 +177,16 @@ char_map **c_varmap_alloc(char_map ** map, const char *key, const char *val);
 void c_varmap_free(char_map ** map);
 //! @}
 
+//! @{
+//! @name Compiled regular characters substitution APIs, for strings substituted repeatedly
+char_template *c_varsub_compile(const char *s);
+void c_varsub_free(char_template * t);
+char *c_varsub_render(const char_template * t, const char_map * vars[]);
+char_map_index *c_varmap_index(const char_map * vars[]);
+void c_varmap_index_free(char_map_index * index);
+char *c_varsub_render_index(const char_template * t, const char_map_index * index);
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                           STATIC INLINE PROTOTYPES                         |